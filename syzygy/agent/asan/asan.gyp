@@ -26,6 +26,8 @@
         'allocators_impl.h',
         'block.cc',
         'block.h',
+        'block_checksum.cc',
+        'block_checksum.h',
         'block_impl.h',
         'block_utils.cc',
         'block_utils.h',
@@ -47,18 +49,24 @@
         'heap_managers/block_heap_manager.h',
         'heap_managers/deferred_free_thread.cc',
         'heap_managers/deferred_free_thread.h',
+        'heap_managers/thread_local_block_cache.cc',
+        'heap_managers/thread_local_block_cache.h',
         'heaps/internal_heap.cc',
         'heaps/internal_heap.h',
         'heaps/large_block_heap.cc',
         'heaps/large_block_heap.h',
         'heaps/simple_block_heap.cc',
         'heaps/simple_block_heap.h',
+        'heaps/slab_block_heap.cc',
+        'heaps/slab_block_heap.h',
         'heaps/win_heap.cc',
         'heaps/win_heap.h',
         'heaps/zebra_block_heap.cc',
         'heaps/zebra_block_heap.h',
         'iat_patcher.cc',
         'iat_patcher.h',
+        'lock_free_circular_queue.h',
+        'lock_free_circular_queue_impl.h',
         'logger.cc',
         'logger.h',
         'memory_interceptors.cc',
@@ -75,8 +83,12 @@
         'page_protection_helpers.cc',
         'page_protection_helpers.h',
         'quarantine.h',
+        'quarantines/per_cpu_quarantine.h',
+        'quarantines/per_cpu_quarantine_impl.h',
         'quarantines/sharded_quarantine.h',
         'quarantines/sharded_quarantine_impl.h',
+        'quarantines/size_class_quarantine.h',
+        'quarantines/size_class_quarantine_impl.h',
         'quarantines/size_limited_quarantine.h',
         'quarantines/size_limited_quarantine_impl.h',
         'reporters/breakpad_reporter.cc',
@@ -93,6 +105,7 @@
         'reporter.h',
         'runtime.cc',
         'runtime.h',
+        'runtime_statistics.h',
         'runtime_util.cc',
         'runtime_util.h',
         'scoped_page_protections.cc',
@@ -102,6 +115,8 @@
         'shadow_impl.h',
         'shadow_marker.cc',
         'shadow_marker.h',
+        'shadow_simd.cc',
+        'shadow_simd.h',
         'stack_capture_cache.cc',
         'stack_capture_cache.h',
         'system_interceptors.cc',
@@ -171,12 +186,14 @@
       'sources': [
         'allocators_unittest.cc',
         'crt_interceptors_unittest.cc',
+        'block_checksum_unittest.cc',
         'block_unittest.cc',
         'block_utils_unittest.cc',
         'circular_queue_unittest.cc',
         'error_info_unittest.cc',
         'heap_checker_unittest.cc',
         'iat_patcher_unittest.cc',
+        'lock_free_circular_queue_unittest.cc',
         'logger_unittest.cc',
         'memory_interceptors_patcher_unittest.cc',
         'memory_interceptors_unittest.cc',
@@ -189,6 +206,7 @@
         'runtime_unittest.cc',
         'scoped_page_protections_unittest.cc',
         'shadow_marker_unittest.cc',
+        'shadow_simd_unittest.cc',
         'shadow_unittest.cc',
         'stack_capture_cache_unittest.cc',
         'system_interceptors_unittest.cc',
@@ -197,12 +215,16 @@
         'heaps/internal_heap_unittest.cc',
         'heaps/large_block_heap_unittest.cc',
         'heaps/simple_block_heap_unittest.cc',
+        'heaps/slab_block_heap_unittest.cc',
         'heaps/win_heap_unittest.cc',
         'heaps/zebra_block_heap_unittest.cc',
         'heap_managers/block_heap_manager_unittest.cc',
         'heap_managers/deferred_free_thread_unittest.cc',
+        'heap_managers/thread_local_block_cache_unittest.cc',
         'memory_notifiers/shadow_memory_notifier_unittest.cc',
+        'quarantines/per_cpu_quarantine_unittest.cc',
         'quarantines/sharded_quarantine_unittest.cc',
+        'quarantines/size_class_quarantine_unittest.cc',
         'quarantines/size_limited_quarantine_unittest.cc',
         'reporters/breakpad_reporter_unittest.cc',
         'reporters/crashpad_reporter_unittest.cc',
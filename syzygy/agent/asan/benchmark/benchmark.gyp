@@ -0,0 +1,78 @@
+# Copyright 2017 Google Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# The heap manager benchmark lives in a project of its own, as bard (used for
+# the replay of the stories) itself depends on the ASan project.
+{
+  'variables': {
+    'chromium_code': 1,
+  },
+  'targets': [
+    {
+      'target_name': 'syzyasan_heap_benchmark_lib',
+      'type': 'static_library',
+      'sources': [
+        'heap_manager_benchmark.cc',
+        'heap_manager_benchmark.h',
+        'heap_manager_benchmark_app.cc',
+        'heap_manager_benchmark_app.h',
+        'windows_heap_back_end.cc',
+        'windows_heap_back_end.h',
+      ],
+      'dependencies': [
+        '<(src)/base/base.gyp:base',
+        '<(src)/syzygy/agent/asan/asan.gyp:syzyasan_rtl_lib',
+        '<(src)/syzygy/application/application.gyp:application_lib',
+        '<(src)/syzygy/bard/bard.gyp:bard_lib',
+        '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
+      ],
+    },
+    {
+      'target_name': 'syzyasan_heap_benchmark',
+      'type': 'executable',
+      'sources': [
+        'heap_manager_benchmark_main.cc',
+      ],
+      'dependencies': [
+        'syzyasan_heap_benchmark_lib',
+      ],
+      'libraries': [
+        'psapi.lib',
+      ],
+    },
+    {
+      'target_name': 'syzyasan_heap_benchmark_unittests',
+      'type': 'executable',
+      'sources': [
+        'heap_manager_benchmark_app_unittest.cc',
+        'heap_manager_benchmark_unittest.cc',
+        'windows_heap_back_end_unittest.cc',
+        '<(src)/syzygy/testing/run_all_unittests.cc',
+      ],
+      'dependencies': [
+        'syzyasan_heap_benchmark_lib',
+        '<(src)/base/base.gyp:base',
+        '<(src)/base/base.gyp:test_support_base',
+        '<(src)/syzygy/common/common.gyp:common_unittest_utils',
+        '<(src)/syzygy/core/core.gyp:core_unittest_utils',
+        '<(src)/testing/gmock.gyp:gmock',
+        '<(src)/testing/gtest.gyp:gtest',
+      ],
+      'libraries': [
+        'psapi.lib',
+      ],
+    },
+  ],
+}
@@ -0,0 +1,819 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/benchmark/heap_manager_benchmark.h"
+
+#include <windows.h>  // NOLINT
+#include <intrin.h>
+#include <psapi.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+#include "base/bind.h"
+#include "base/files/file_util.h"
+#include "base/memory/scoped_vector.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
+#include "syzygy/bard/story.h"
+#include "syzygy/bard/backdrops/heap_backdrop.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/core/zstream.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+namespace {
+
+using heap_managers::BlockHeapManager;
+typedef HeapManagerInterface::HeapId HeapId;
+
+// The interval at which the private bytes of the process are sampled.
+const int kSamplingIntervalMs = 10;
+
+// Invoked by the heap manager when it encounters heap corruption. There's no
+// point in carrying on benchmarking a corrupt heap.
+void OnHeapError(AsanErrorInfo* error_info) {
+  LOG(FATAL) << "Heap corruption encountered during the benchmark.";
+}
+
+// @returns the current private bytes of the process.
+uint64_t GetPrivateBytes() {
+  PROCESS_MEMORY_COUNTERS_EX counters = {};
+  if (!::GetProcessMemoryInfo(
+          ::GetCurrentProcess(),
+          reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters),
+          sizeof(counters))) {
+    return 0;
+  }
+  return counters.PrivateUsage;
+}
+
+// Samples the private bytes of the process on a background thread, and keeps
+// track of their peak growth.
+class PrivateBytesSampler : public base::PlatformThread::Delegate {
+ public:
+  PrivateBytesSampler()
+      : stop_event_(false, false), start_bytes_(0), peak_bytes_(0) {
+  }
+
+  // Starts sampling.
+  void Start() {
+    start_bytes_ = GetPrivateBytes();
+    peak_bytes_ = start_bytes_;
+    CHECK(base::PlatformThread::Create(0, this, &handle_));
+  }
+
+  // Stops sampling.
+  // @returns the peak growth of the private bytes since the call to Start.
+  uint64_t Stop() {
+    stop_event_.Signal();
+    base::PlatformThread::Join(handle_);
+    Sample();
+    return peak_bytes_ - start_bytes_;
+  }
+
+  // @name base::PlatformThread::Delegate implementation.
+  // @{
+  void ThreadMain() override {
+    while (!stop_event_.TimedWait(
+        base::TimeDelta::FromMilliseconds(kSamplingIntervalMs))) {
+      Sample();
+    }
+  }
+  // @}
+
+ private:
+  void Sample() {
+    peak_bytes_ = std::max(peak_bytes_, GetPrivateBytes());
+  }
+
+  base::WaitableEvent stop_event_;
+  base::PlatformThreadHandle handle_;
+  uint64_t start_bytes_;
+  uint64_t peak_bytes_;  // Only accessed by the sampling thread while running.
+
+  DISALLOW_COPY_AND_ASSIGN(PrivateBytesSampler);
+};
+
+// A small and fast pseudo-random number generator (xorshift64*). The workload
+// threads each have their own, seeded deterministically so that runs are
+// reproducible.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed | 1) {
+  }
+
+  // @returns the next pseudo-random number.
+  uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ull;
+  }
+
+  // @returns a pseudo-random number in [0, 1).
+  double NextDouble() {
+    return static_cast<double>(Next() >> 11) / static_cast<double>(1ull << 53);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// Runs the synthetic workload of a single thread.
+class WorkloadRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  WorkloadRunner(const SyntheticWorkload& workload,
+                 HeapManagerInterface* heap_manager,
+                 HeapId heap_id,
+                 uint64_t seed,
+                 base::WaitableEvent* free_event)
+      : workload_(workload),
+        heap_manager_(heap_manager),
+        heap_id_(heap_id),
+        random_(seed),
+        free_event_(free_event),
+        done_event_(true, false),
+        peak_requested_bytes_(0),
+        failed_(false) {
+    DCHECK_NE(static_cast<HeapManagerInterface*>(nullptr), heap_manager);
+    DCHECK_NE(static_cast<base::WaitableEvent*>(nullptr), free_event);
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override;
+  // @}
+
+  // @name Accessors.
+  // @{
+  base::WaitableEvent* done_event() { return &done_event_; }
+  std::vector<uint64_t>* allocation_latencies() {
+    return &allocation_latencies_;
+  }
+  std::vector<uint64_t>* free_latencies() { return &free_latencies_; }
+  uint64_t peak_requested_bytes() const { return peak_requested_bytes_; }
+  bool failed() const { return failed_; }
+  // @}
+
+ private:
+  // @returns the size of the next allocation.
+  uint32_t GetNextSize();
+
+  const SyntheticWorkload& workload_;
+  HeapManagerInterface* heap_manager_;
+  HeapId heap_id_;
+  Random random_;
+
+  // Signaled by the main thread when the remaining allocations can be freed.
+  base::WaitableEvent* free_event_;
+  // Signaled when the timed part of the workload is done.
+  base::WaitableEvent done_event_;
+
+  // The measurements.
+  std::vector<uint64_t> allocation_latencies_;
+  std::vector<uint64_t> free_latencies_;
+  uint64_t peak_requested_bytes_;
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkloadRunner);
+};
+
+void WorkloadRunner::Run() {
+  std::vector<void*> allocs(workload_.live_allocation_count, nullptr);
+  std::vector<uint32_t> sizes(workload_.live_allocation_count, 0);
+  allocation_latencies_.reserve(workload_.operation_count);
+  free_latencies_.reserve(workload_.operation_count);
+
+  uint64_t requested_bytes = 0;
+  for (size_t i = 0; i < workload_.operation_count; ++i) {
+    size_t slot = static_cast<size_t>(random_.Next() % allocs.size());
+
+    if (allocs[slot] != nullptr) {
+      uint64_t start = ::__rdtsc();
+      bool freed = heap_manager_->Free(heap_id_, allocs[slot]);
+      free_latencies_.push_back(::__rdtsc() - start);
+      if (!freed) {
+        LOG(ERROR) << "Failed to free an allocation.";
+        failed_ = true;
+        break;
+      }
+      allocs[slot] = nullptr;
+      requested_bytes -= sizes[slot];
+    }
+
+    uint32_t size = GetNextSize();
+    uint64_t start = ::__rdtsc();
+    void* alloc = heap_manager_->Allocate(heap_id_, size);
+    allocation_latencies_.push_back(::__rdtsc() - start);
+    if (alloc == nullptr) {
+      LOG(ERROR) << "Failed to allocate " << size << " bytes.";
+      failed_ = true;
+      break;
+    }
+    allocs[slot] = alloc;
+    sizes[slot] = size;
+    requested_bytes += size;
+    peak_requested_bytes_ = std::max(peak_requested_bytes_, requested_bytes);
+  }
+
+  // Hold on to the live allocations until all the threads are done, so that
+  // the memory usage can be measured at its peak.
+  done_event_.Signal();
+  free_event_->Wait();
+
+  for (void* alloc : allocs) {
+    if (alloc != nullptr)
+      heap_manager_->Free(heap_id_, alloc);
+  }
+}
+
+uint32_t WorkloadRunner::GetNextSize() {
+  uint32_t min_size = workload_.min_size;
+  uint32_t max_size = workload_.max_size;
+  DCHECK_LE(min_size, max_size);
+
+  if (workload_.size_distribution == kUniformSizeDistribution) {
+    uint64_t range = static_cast<uint64_t>(max_size) - min_size + 1;
+    return min_size + static_cast<uint32_t>(random_.Next() % range);
+  }
+
+  DCHECK_EQ(kLogUniformSizeDistribution, workload_.size_distribution);
+  double log_min = std::log(static_cast<double>(std::max(min_size, 1u)));
+  double log_max = std::log(static_cast<double>(max_size) + 1.0);
+  double size = std::exp(log_min + random_.NextDouble() * (log_max - log_min));
+  return std::min(std::max(static_cast<uint32_t>(size), min_size), max_size);
+}
+
+// Summarizes a set of latency measurements. This reorders the measurements.
+void SummarizeLatencies(std::vector<uint64_t>* latencies,
+                        LatencyDistribution* distribution) {
+  DCHECK_NE(static_cast<std::vector<uint64_t>*>(nullptr), latencies);
+  DCHECK_NE(static_cast<LatencyDistribution*>(nullptr), distribution);
+
+  ::memset(distribution, 0, sizeof(*distribution));
+  if (latencies->empty())
+    return;
+
+  uint64_t total = 0;
+  for (uint64_t latency : *latencies) {
+    total += latency;
+    ++distribution->histogram[GetLatencyBucket(latency)];
+  }
+  distribution->count = latencies->size();
+  distribution->mean = total / latencies->size();
+
+  auto p50 = latencies->begin() + latencies->size() / 2;
+  std::nth_element(latencies->begin(), p50, latencies->end());
+  distribution->p50 = *p50;
+  auto p99 = latencies->begin() + latencies->size() * 99 / 100;
+  std::nth_element(latencies->begin(), p99, latencies->end());
+  distribution->p99 = *p99;
+}
+
+// The state shared by the adapters of the heap backdrop during a replay.
+// This is updated concurrently by the plot lines of the stories.
+struct ReplayContext {
+  HeapManagerInterface* heap_manager;
+  HeapId process_heap;
+
+  // The histograms and the total of the latencies of the allocations and of
+  // the frees.
+  volatile LONG64 allocation_histogram[kLatencyBucketCount];
+  volatile LONG64 free_histogram[kLatencyBucketCount];
+  volatile LONG64 allocation_time;
+  volatile LONG64 free_time;
+
+  // The bytes requested by the live allocations, and their peak.
+  volatile LONG64 requested_bytes;
+  volatile LONG64 peak_requested_bytes;
+};
+
+// Records a latency in a histogram of a replay.
+void RecordLatency(volatile LONG64* histogram,
+                   volatile LONG64* time,
+                   uint64_t latency) {
+  ::InterlockedIncrement64(&histogram[GetLatencyBucket(latency)]);
+  ::InterlockedExchangeAdd64(time, latency);
+}
+
+// Adjusts the bytes requested by the live allocations of a replay, and keeps
+// track of their peak.
+void AddRequestedBytes(ReplayContext* context, int64_t delta) {
+  LONG64 requested =
+      ::InterlockedExchangeAdd64(&context->requested_bytes, delta) + delta;
+  LONG64 peak = context->peak_requested_bytes;
+  while (requested > peak) {
+    LONG64 previous = ::InterlockedCompareExchange64(
+        &context->peak_requested_bytes, requested, peak);
+    if (previous == peak)
+      break;
+    peak = previous;
+  }
+}
+
+// Summarizes the latencies measured during a replay. The percentiles are the
+// upper bounds of the histogram buckets they fall in.
+void SummarizeHistogram(const volatile LONG64* histogram,
+                        LONG64 time,
+                        LatencyDistribution* distribution) {
+  ::memset(distribution, 0, sizeof(*distribution));
+  uint64_t total = 0;
+  for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+    distribution->histogram[i] = histogram[i];
+    total += distribution->histogram[i];
+  }
+  if (total == 0)
+    return;
+  distribution->count = total;
+  distribution->mean = time / total;
+
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+    uint64_t previous = cumulative;
+    cumulative += distribution->histogram[i];
+    uint64_t upper_bound = i == 0 ? 0 : (1ull << i) - 1;
+    if (previous <= total / 2 && total / 2 < cumulative)
+      distribution->p50 = upper_bound;
+    if (previous <= total * 99 / 100 && total * 99 / 100 < cumulative)
+      distribution->p99 = upper_bound;
+  }
+}
+
+// @name Adapters from the heap API used by the heap backdrop to the back end.
+//     The heap IDs are used as heap handles. The latencies are measured here
+//     rather than taken from the backdrop, so that their distribution is
+//     known.
+// @{
+LPVOID BackdropHeapAlloc(ReplayContext* context,
+                         HANDLE heap,
+                         DWORD flags,
+                         SIZE_T bytes) {
+  uint64_t start = ::__rdtsc();
+  void* alloc = context->heap_manager->Allocate(
+      reinterpret_cast<HeapId>(heap), static_cast<uint32_t>(bytes));
+  RecordLatency(context->allocation_histogram, &context->allocation_time,
+                ::__rdtsc() - start);
+  if (alloc == nullptr)
+    return nullptr;
+  if ((flags & HEAP_ZERO_MEMORY) != 0)
+    ::memset(alloc, 0, bytes);
+  AddRequestedBytes(context, bytes);
+  return alloc;
+}
+
+HANDLE BackdropHeapCreate(ReplayContext* context,
+                          DWORD options,
+                          SIZE_T initial_size,
+                          SIZE_T maximum_size) {
+  return reinterpret_cast<HANDLE>(context->heap_manager->CreateHeap());
+}
+
+BOOL BackdropHeapDestroy(ReplayContext* context, HANDLE heap) {
+  // The process heap stands in for the one of the trace, and outlives it.
+  HeapId heap_id = reinterpret_cast<HeapId>(heap);
+  if (heap_id == context->process_heap)
+    return TRUE;
+  return context->heap_manager->DestroyHeap(heap_id);
+}
+
+BOOL BackdropHeapFree(ReplayContext* context,
+                      HANDLE heap,
+                      DWORD flags,
+                      LPVOID mem) {
+  HeapId heap_id = reinterpret_cast<HeapId>(heap);
+  uint32_t size = 0;
+  if (mem != nullptr)
+    size = context->heap_manager->Size(heap_id, mem);
+
+  uint64_t start = ::__rdtsc();
+  bool freed = context->heap_manager->Free(heap_id, mem);
+  RecordLatency(context->free_histogram, &context->free_time,
+                ::__rdtsc() - start);
+  if (freed)
+    AddRequestedBytes(context, -static_cast<int64_t>(size));
+  return freed;
+}
+
+LPVOID BackdropHeapReAlloc(ReplayContext* context,
+                           HANDLE heap,
+                           DWORD flags,
+                           LPVOID mem,
+                           SIZE_T bytes) {
+  HeapManagerInterface* heap_manager = context->heap_manager;
+  HeapId heap_id = reinterpret_cast<HeapId>(heap);
+
+  // The reallocation is timed as a whole, as an allocation.
+  uint64_t start = ::__rdtsc();
+  void* alloc = heap_manager->Allocate(heap_id, static_cast<uint32_t>(bytes));
+  if (alloc == nullptr) {
+    RecordLatency(context->allocation_histogram, &context->allocation_time,
+                ::__rdtsc() - start);
+    return nullptr;
+  }
+  uint32_t old_size = 0;
+  if (mem != nullptr) {
+    old_size = heap_manager->Size(heap_id, mem);
+    ::memcpy(alloc, mem, std::min(static_cast<SIZE_T>(old_size), bytes));
+    heap_manager->Free(heap_id, mem);
+  }
+  RecordLatency(context->allocation_histogram, &context->allocation_time,
+                ::__rdtsc() - start);
+  AddRequestedBytes(context, static_cast<int64_t>(bytes) - old_size);
+  return alloc;
+}
+
+BOOL BackdropHeapSetInformation(ReplayContext* context,
+                                HANDLE heap,
+                                HEAP_INFORMATION_CLASS info_class,
+                                PVOID info,
+                                SIZE_T info_length) {
+  return TRUE;
+}
+
+SIZE_T BackdropHeapSize(ReplayContext* context,
+                        HANDLE heap,
+                        DWORD flags,
+                        LPCVOID mem) {
+  return context->heap_manager->Size(reinterpret_cast<HeapId>(heap), mem);
+}
+// @}
+
+// Plugs a heap backdrop into the back end of a replay.
+void SetUpBackdrop(ReplayContext* context,
+                   bard::backdrops::HeapBackdrop* backdrop) {
+  backdrop->set_heap_alloc(base::Bind(&BackdropHeapAlloc,
+                                      base::Unretained(context)));
+  backdrop->set_heap_create(base::Bind(&BackdropHeapCreate,
+                                       base::Unretained(context)));
+  backdrop->set_heap_destroy(base::Bind(&BackdropHeapDestroy,
+                                        base::Unretained(context)));
+  backdrop->set_heap_free(base::Bind(&BackdropHeapFree,
+                                     base::Unretained(context)));
+  backdrop->set_heap_realloc(base::Bind(&BackdropHeapReAlloc,
+                                        base::Unretained(context)));
+  backdrop->set_heap_set_information(base::Bind(
+      &BackdropHeapSetInformation, base::Unretained(context)));
+  backdrop->set_heap_size(base::Bind(&BackdropHeapSize,
+                                     base::Unretained(context)));
+}
+
+// Loads the heaps that existed when a trace started. The first of these is
+// the process heap.
+bool LoadTraceHeaps(core::InArchive* in_archive,
+                    std::vector<uintptr_t>* trace_heaps) {
+  size_t heap_count = 0;
+  if (!in_archive->Load(&heap_count))
+    return false;
+  trace_heaps->resize(heap_count);
+  for (size_t i = 0; i < heap_count; ++i) {
+    if (!in_archive->Load(&(*trace_heaps)[i]))
+      return false;
+  }
+  return true;
+}
+
+// Loads all the stories of a file written by the memory replay grinder as a
+// sequence of chunks. Those are interleaved across the stories, so the
+// stories are all loaded before any of them is played.
+bool LoadChunkedStories(core::InArchive* in_archive,
+                        size_t chunk_count,
+                        std::vector<std::vector<uintptr_t>>* trace_heaps,
+                        ScopedVector<bard::Story>* stories) {
+  std::map<uint32_t, std::unique_ptr<bard::Story>> stories_by_process;
+  for (size_t i = 0; i < chunk_count; ++i) {
+    uint32_t process_id = 0;
+    if (!in_archive->Load(&process_id))
+      return false;
+    std::unique_ptr<bard::Story>& story = stories_by_process[process_id];
+    if (!story)
+      story.reset(new bard::Story());
+    if (!story->LoadChunk(in_archive)) {
+      LOG(ERROR) << "Failed to load story chunk " << i << ".";
+      return false;
+    }
+  }
+
+  // The heaps of each process follow the chunks. The stories are ordered
+  // like them, an empty story standing in for a process with no events.
+  size_t process_count = 0;
+  if (!in_archive->Load(&process_count))
+    return false;
+  trace_heaps->resize(process_count);
+  for (size_t i = 0; i < process_count; ++i) {
+    uint32_t process_id = 0;
+    if (!in_archive->Load(&process_id) ||
+        !LoadTraceHeaps(in_archive, &(*trace_heaps)[i])) {
+      return false;
+    }
+    std::unique_ptr<bard::Story>& story = stories_by_process[process_id];
+    if (!story)
+      story.reset(new bard::Story());
+    stories->push_back(story.release());
+  }
+
+  return true;
+}
+
+}  // namespace
+
+size_t GetLatencyBucket(uint64_t latency) {
+  size_t bucket = 0;
+  while (latency != 0 && bucket < kLatencyBucketCount - 1) {
+    latency >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+SyntheticWorkload::SyntheticWorkload()
+    : thread_count(1),
+      operation_count(100000),
+      live_allocation_count(1000),
+      min_size(1),
+      max_size(4096),
+      size_distribution(kLogUniformSizeDistribution) {
+}
+
+double BenchmarkResults::GetThroughput() const {
+  double seconds = elapsed.InSecondsF();
+  if (seconds == 0.0)
+    return 0.0;
+  return (allocation_latency.count + free_latency.count) / seconds;
+}
+
+double BenchmarkResults::GetMemoryOverhead() const {
+  if (peak_requested_bytes == 0)
+    return 0.0;
+  return static_cast<double>(peak_private_bytes) / peak_requested_bytes;
+}
+
+double BenchmarkResults::GetFragmentation() const {
+  if (peak_requested_bytes == 0 || peak_private_bytes <= peak_requested_bytes)
+    return 0.0;
+  return 1.0 - static_cast<double>(peak_requested_bytes) / peak_private_bytes;
+}
+
+HeapManagerBenchmark::HeapManagerBenchmark()
+    : back_end_(nullptr), process_heap_(0) {
+}
+
+HeapManagerBenchmark::~HeapManagerBenchmark() {
+  // Tear down in the reverse order of the set up.
+  back_end_ = nullptr;
+  windows_heap_.reset();
+  heap_manager_.reset();
+  stack_cache_.reset();
+  logger_.reset();
+  memory_notifier_.reset();
+  if (shadow_.get() != nullptr && shadow_->shadow() != nullptr)
+    shadow_->TearDown();
+  shadow_.reset();
+}
+
+bool HeapManagerBenchmark::Init(const ::common::AsanParameters& parameters) {
+  DCHECK_EQ(static_cast<HeapManagerInterface*>(nullptr), back_end_);
+
+  shadow_.reset(new Shadow());
+  if (shadow_->shadow() == nullptr) {
+    LOG(ERROR) << "Failed to allocate the shadow memory.";
+    return false;
+  }
+  shadow_->SetUp();
+
+  memory_notifier_.reset(
+      new memory_notifiers::ShadowMemoryNotifier(shadow_.get()));
+  // The logger isn't bound to a logging service, so the stack cache
+  // statistics are simply dropped.
+  logger_.reset(new AsanLogger());
+  stack_cache_.reset(
+      new StackCaptureCache(logger_.get(), memory_notifier_.get()));
+
+  heap_manager_.reset(new BlockHeapManager(
+      shadow_.get(), stack_cache_.get(), memory_notifier_.get()));
+  heap_manager_->SetHeapErrorCallback(base::Bind(&OnHeapError));
+  heap_manager_->set_parameters(parameters);
+  heap_manager_->Init();
+
+  back_end_ = heap_manager_.get();
+  process_heap_ = heap_manager_->process_heap();
+  return true;
+}
+
+bool HeapManagerBenchmark::InitProcessHeap() {
+  DCHECK_EQ(static_cast<HeapManagerInterface*>(nullptr), back_end_);
+
+  windows_heap_.reset(new WindowsHeapBackEnd());
+  if (!windows_heap_->InitProcessHeap())
+    return false;
+
+  back_end_ = windows_heap_.get();
+  process_heap_ = windows_heap_->process_heap();
+  return true;
+}
+
+bool HeapManagerBenchmark::InitHeapDll(const base::FilePath& path,
+                                       const std::string& prefix) {
+  DCHECK_EQ(static_cast<HeapManagerInterface*>(nullptr), back_end_);
+
+  windows_heap_.reset(new WindowsHeapBackEnd());
+  if (!windows_heap_->InitHeapDll(path, prefix))
+    return false;
+
+  back_end_ = windows_heap_.get();
+  process_heap_ = windows_heap_->process_heap();
+  return true;
+}
+
+bool HeapManagerBenchmark::RunSyntheticWorkload(
+    const SyntheticWorkload& workload, BenchmarkResults* results) {
+  DCHECK_NE(static_cast<HeapManagerInterface*>(nullptr), back_end_);
+  DCHECK_NE(static_cast<BenchmarkResults*>(nullptr), results);
+  DCHECK_LT(0u, workload.thread_count);
+  DCHECK_LT(0u, workload.live_allocation_count);
+  DCHECK_LE(workload.min_size, workload.max_size);
+
+  base::WaitableEvent free_event(true, false);
+  ScopedVector<WorkloadRunner> runners;
+  ScopedVector<base::DelegateSimpleThread> threads;
+  for (size_t i = 0; i < workload.thread_count; ++i) {
+    runners.push_back(new WorkloadRunner(workload, back_end_, process_heap_,
+                                         i + 1, &free_event));
+    threads.push_back(new base::DelegateSimpleThread(runners.back(),
+                                                     "HeapManagerBenchmark"));
+  }
+
+  PrivateBytesSampler sampler;
+  sampler.Start();
+  base::TimeTicks start = base::TimeTicks::Now();
+  for (auto thread : threads)
+    thread->Start();
+  for (auto runner : runners)
+    runner->done_event()->Wait();
+  results->elapsed = base::TimeTicks::Now() - start;
+  results->peak_private_bytes = sampler.Stop();
+
+  free_event.Signal();
+  for (auto thread : threads)
+    thread->Join();
+
+  // Merge the measurements of all the threads. Each thread holds its peak at
+  // about the same time, so the sum of these is a fair estimate of the total.
+  std::vector<uint64_t> allocation_latencies;
+  std::vector<uint64_t> free_latencies;
+  results->peak_requested_bytes = 0;
+  bool failed = false;
+  for (auto runner : runners) {
+    allocation_latencies.insert(allocation_latencies.end(),
+                                runner->allocation_latencies()->begin(),
+                                runner->allocation_latencies()->end());
+    free_latencies.insert(free_latencies.end(),
+                          runner->free_latencies()->begin(),
+                          runner->free_latencies()->end());
+    results->peak_requested_bytes += runner->peak_requested_bytes();
+    failed |= runner->failed();
+  }
+  SummarizeLatencies(&allocation_latencies, &results->allocation_latency);
+  SummarizeLatencies(&free_latencies, &results->free_latency);
+  GetStatistics(&results->statistics);
+
+  return !failed;
+}
+
+bool HeapManagerBenchmark::ReplayStories(const base::FilePath& path,
+                                         BenchmarkResults* results) {
+  DCHECK_NE(static_cast<HeapManagerInterface*>(nullptr), back_end_);
+  DCHECK_NE(static_cast<BenchmarkResults*>(nullptr), results);
+
+  // This reads the format written by the memory replay grinder.
+  base::ScopedFILE file(base::OpenFile(path, "rb"));
+  if (file.get() == nullptr) {
+    LOG(ERROR) << "Failed to open \"" << path.value() << "\".";
+    return false;
+  }
+  core::FileInStream in_stream(file.get());
+  core::ZInStream zin_stream(&in_stream);
+  core::NativeBinaryInArchive in_archive(&zin_stream);
+  if (!zin_stream.Init())
+    return false;
+
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  size_t story_count = 0;
+  if (!in_archive.Load(&magic) || !in_archive.Load(&version) ||
+      !in_archive.Load(&story_count)) {
+    LOG(ERROR) << "Failed to read the header of \"" << path.value() << "\".";
+    return false;
+  }
+  if (magic != bard::Story::kBardMagic ||
+      (version != bard::Story::kBardVersion &&
+       version != bard::Story::kBardChunkedVersion)) {
+    LOG(ERROR) << "\"" << path.value() << "\" is not a supported story file.";
+    return false;
+  }
+
+  // Chunked files are loaded up front, while other files are loaded one
+  // story at a time as they are played.
+  bool chunked = version == bard::Story::kBardChunkedVersion;
+  std::vector<std::vector<uintptr_t>> chunked_trace_heaps;
+  ScopedVector<bard::Story> chunked_stories;
+  if (chunked) {
+    if (!LoadChunkedStories(&in_archive, story_count, &chunked_trace_heaps,
+                            &chunked_stories)) {
+      LOG(ERROR) << "Failed to load the stories of \"" << path.value()
+                 << "\".";
+      return false;
+    }
+    story_count = chunked_stories.size();
+  }
+
+  ReplayContext context = {};
+  context.heap_manager = back_end_;
+  context.process_heap = process_heap_;
+
+  PrivateBytesSampler sampler;
+  sampler.Start();
+  base::TimeTicks start = base::TimeTicks::Now();
+  bool success = true;
+  for (size_t i = 0; i < story_count && success; ++i) {
+    bard::backdrops::HeapBackdrop backdrop;
+    SetUpBackdrop(&context, &backdrop);
+
+    // The heaps that existed when the trace started. The first of these is
+    // the process heap.
+    std::vector<uintptr_t> loaded_trace_heaps;
+    std::unique_ptr<bard::Story> loaded_story;
+    const std::vector<uintptr_t>* trace_heaps = nullptr;
+    bard::Story* story = nullptr;
+    if (chunked) {
+      trace_heaps = &chunked_trace_heaps[i];
+      story = chunked_stories[i];
+    } else {
+      loaded_story.reset(new bard::Story());
+      if (!LoadTraceHeaps(&in_archive, &loaded_trace_heaps) ||
+          !loaded_story->Load(&in_archive)) {
+        LOG(ERROR) << "Failed to load story " << i << ".";
+        success = false;
+        break;
+      }
+      trace_heaps = &loaded_trace_heaps;
+      story = loaded_story.get();
+    }
+    for (size_t j = 0; j < trace_heaps->size(); ++j) {
+      HeapId live_heap = j == 0 ? process_heap_ : back_end_->CreateHeap();
+      backdrop.heap_map().AddMapping(
+          reinterpret_cast<HANDLE>((*trace_heaps)[j]),
+          reinterpret_cast<HANDLE>(live_heap));
+    }
+
+    if (!story->Play(&backdrop)) {
+      LOG(ERROR) << "Failed to play story " << i << ".";
+      success = false;
+    }
+
+    if (!backdrop.TearDown())
+      success = false;
+  }
+  results->elapsed = base::TimeTicks::Now() - start;
+  results->peak_private_bytes = sampler.Stop();
+
+  SummarizeHistogram(context.allocation_histogram, context.allocation_time,
+                     &results->allocation_latency);
+  SummarizeHistogram(context.free_histogram, context.free_time,
+                     &results->free_latency);
+  results->peak_requested_bytes = context.peak_requested_bytes;
+  GetStatistics(&results->statistics);
+
+  return success;
+}
+
+void HeapManagerBenchmark::GetStatistics(AsanRuntimeStatistics* statistics) {
+  DCHECK_NE(static_cast<AsanRuntimeStatistics*>(nullptr), statistics);
+  ::memset(statistics, 0, sizeof(*statistics));
+  statistics->size = sizeof(*statistics);
+  if (heap_manager_.get() == nullptr)
+    return;
+  heap_manager_->GetStatistics(statistics);
+  stack_cache_->GetHitCounts(&statistics->stack_cache_requests,
+                             &statistics->stack_cache_hits);
+}
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
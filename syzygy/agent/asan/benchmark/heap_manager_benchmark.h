@@ -0,0 +1,206 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares HeapManagerBenchmark, which drives a heap back end through either
+// a synthetic allocation workload or allocation traces replayed from bard
+// stories, and measures its throughput, latency and memory overhead.
+//
+// The back end is either a BlockHeapManager, the Windows heaps or the heaps
+// of a custom heap DLL. The BlockHeapManager is set up on its own shadow,
+// stack cache and memory notifier, without the rest of the runtime, so that
+// the measurements only reflect the allocator. The heaps and quarantines in
+// use are selected via the usual AsanParameters.
+
+#ifndef SYZYGY_AGENT_ASAN_BENCHMARK_HEAP_MANAGER_BENCHMARK_H_
+#define SYZYGY_AGENT_ASAN_BENCHMARK_HEAP_MANAGER_BENCHMARK_H_
+
+#include <memory>
+#include <string>
+
+#include "base/files/file_path.h"
+#include "base/time/time.h"
+#include "syzygy/agent/asan/logger.h"
+#include "syzygy/agent/asan/runtime_statistics.h"
+#include "syzygy/agent/asan/shadow.h"
+#include "syzygy/agent/asan/stack_capture_cache.h"
+#include "syzygy/agent/asan/benchmark/windows_heap_back_end.h"
+#include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
+#include "syzygy/agent/asan/memory_notifiers/shadow_memory_notifier.h"
+#include "syzygy/common/asan_parameters.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+// The distributions from which the synthetic workload draws its allocation
+// sizes.
+enum SizeDistribution {
+  // Sizes are uniformly distributed.
+  kUniformSizeDistribution,
+  // Sizes are uniformly distributed on a logarithmic scale. This favours small
+  // allocations, like most real workloads do.
+  kLogUniformSizeDistribution,
+};
+
+// Describes a synthetic workload. Each thread keeps a window of
+// |live_allocation_count| slots; each operation frees the allocation held by
+// a random slot and replaces it by a new one. An allocation thus lives for
+// |live_allocation_count| operations on average.
+struct SyntheticWorkload {
+  SyntheticWorkload();
+
+  // The number of threads allocating concurrently.
+  size_t thread_count;
+  // The number of allocations performed by each thread.
+  size_t operation_count;
+  // The size of the allocation window of each thread.
+  size_t live_allocation_count;
+  // The range and distribution of the allocation sizes. The range is
+  // inclusive.
+  uint32_t min_size;
+  uint32_t max_size;
+  SizeDistribution size_distribution;
+};
+
+// The number of buckets of a latency histogram. Bucket 0 counts the
+// latencies of zero, and bucket i > 0 those in [2^(i - 1), 2^i), the last
+// bucket also counting all the larger ones.
+const size_t kLatencyBucketCount = 40;
+
+// Summarizes the latency of a type of heap operation, in cycles as measured
+// by rdtsc.
+struct LatencyDistribution {
+  // The number of operations.
+  uint64_t count;
+  // The average latency.
+  uint64_t mean;
+  // The median and 99th percentile latencies. These are exact for the
+  // synthetic workloads. For replayed stories they are the upper bounds of
+  // the histogram buckets they fall in.
+  uint64_t p50;
+  uint64_t p99;
+  // The histogram of the latencies.
+  uint64_t histogram[kLatencyBucketCount];
+};
+
+// @returns the histogram bucket of a latency.
+size_t GetLatencyBucket(uint64_t latency);
+
+// The results of a benchmark run.
+struct BenchmarkResults {
+  // The wall time taken by the run.
+  base::TimeDelta elapsed;
+  // The latency of the allocations and of the frees.
+  LatencyDistribution allocation_latency;
+  LatencyDistribution free_latency;
+  // The peak number of bytes requested by the live allocations. For replayed
+  // stories, the allocations left in a heap when it is destroyed are not
+  // discounted.
+  uint64_t peak_requested_bytes;
+  // The peak growth of the private bytes of the process during the run, as
+  // sampled by a background thread. This accounts for the redzones, the
+  // quarantine and the heap metadata.
+  uint64_t peak_private_bytes;
+  // The statistics of the heap manager at the end of the run. These are only
+  // known for the SyzyASan heap manager, and are left to zero otherwise.
+  AsanRuntimeStatistics statistics;
+
+  // @returns the number of heap operations per second.
+  double GetThroughput() const;
+  // @returns the ratio of the memory used to the memory requested, or zero if
+  //     this is unknown.
+  double GetMemoryOverhead() const;
+  // @returns the fraction of the peak private bytes that isn't holding
+  //     requested bytes, or zero if this is unknown. This conflates the
+  //     fragmentation of the heap with its metadata and, for SyzyASan, the
+  //     redzones and the quarantine.
+  double GetFragmentation() const;
+};
+
+// Drives a heap back end and measures its performance. A benchmark can be
+// run any number of times, though the heap manager state (quarantine, stack
+// cache) carries over from one run to the next. One of the Init methods must
+// be called before running it.
+class HeapManagerBenchmark {
+ public:
+  HeapManagerBenchmark();
+  ~HeapManagerBenchmark();
+
+  // Sets up the SyzyASan heap manager.
+  // @param parameters The parameters of the heap manager.
+  // @returns true on success, false otherwise.
+  bool Init(const ::common::AsanParameters& parameters);
+
+  // Sets up the Windows heaps as the back end.
+  // @returns true on success, false otherwise.
+  bool InitProcessHeap();
+
+  // Sets up the heaps of a custom heap DLL as the back end.
+  // @param path The path of the DLL.
+  // @param prefix The prefix of the names of its heap API exports.
+  // @returns true on success, false otherwise.
+  // @note See WindowsHeapBackEnd::InitHeapDll for the required exports.
+  bool InitHeapDll(const base::FilePath& path, const std::string& prefix);
+
+  // Runs a synthetic workload.
+  // @param workload The workload to run.
+  // @param results Will receive the results.
+  // @returns true on success, false otherwise.
+  bool RunSyntheticWorkload(const SyntheticWorkload& workload,
+                            BenchmarkResults* results);
+
+  // Replays the stories saved to a file by the memory replay grinder. The
+  // stories are played one after the other.
+  // @param path The path of the file containing the stories.
+  // @param results Will receive the results.
+  // @returns true on success, false otherwise.
+  bool ReplayStories(const base::FilePath& path, BenchmarkResults* results);
+
+  // @returns the SyzyASan heap manager being benchmarked, if any.
+  heap_managers::BlockHeapManager* heap_manager() const {
+    return heap_manager_.get();
+  }
+
+  // @returns the back end being benchmarked.
+  HeapManagerInterface* back_end() const { return back_end_; }
+
+ protected:
+  // Gets the statistics of the heap manager and of the stack cache, if the
+  // back end is the SyzyASan heap manager.
+  // @param statistics Will receive the statistics.
+  void GetStatistics(AsanRuntimeStatistics* statistics);
+
+  // The components the heap manager depends on.
+  std::unique_ptr<Shadow> shadow_;
+  std::unique_ptr<memory_notifiers::ShadowMemoryNotifier> memory_notifier_;
+  std::unique_ptr<AsanLogger> logger_;
+  std::unique_ptr<StackCaptureCache> stack_cache_;
+
+  // The heap managers that can be benchmarked. Only one of these is set.
+  std::unique_ptr<heap_managers::BlockHeapManager> heap_manager_;
+  std::unique_ptr<WindowsHeapBackEnd> windows_heap_;
+
+  // The back end being benchmarked, and its process heap.
+  HeapManagerInterface* back_end_;
+  HeapManagerInterface::HeapId process_heap_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HeapManagerBenchmark);
+};
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_BENCHMARK_HEAP_MANAGER_BENCHMARK_H_
@@ -0,0 +1,347 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/benchmark/heap_manager_benchmark_app.h"
+
+#include <algorithm>
+
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/stringprintf.h"
+#include "base/strings/utf_string_conversions.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+namespace {
+
+const int kSuccess = 0;
+const int kError = 1;
+
+const char kUsageFormatStr[] =
+    "Usage: %ls [options]\n"
+    "\n"
+    "  Benchmarks heap back ends, and reports their throughput, latency\n"
+    "  and memory overhead. The SyzyASan heap manager is benchmarked in\n"
+    "  each of the selected heap and quarantine configurations.\n"
+    "\n"
+    "Workload options:\n"
+    "  --threads=<n>            The number of allocating threads. Defaults\n"
+    "                           to 1.\n"
+    "  --operations=<n>         The number of allocations per thread.\n"
+    "                           Defaults to 100000.\n"
+    "  --live-allocations=<n>   The number of allocations each thread keeps\n"
+    "                           alive, which governs their lifetime.\n"
+    "                           Defaults to 1000.\n"
+    "  --min-size=<n>           The minimum allocation size. Defaults to 1.\n"
+    "  --max-size=<n>           The maximum allocation size. Defaults to\n"
+    "                           4096.\n"
+    "  --size-distribution=<d>  One of 'uniform' or 'log-uniform'. Defaults\n"
+    "                           to 'log-uniform'.\n"
+    "  --replay=<path>          Replays the stories generated by the memory\n"
+    "                           replay grinder instead of the synthetic\n"
+    "                           workload.\n"
+    "\n"
+    "Back end options:\n"
+    "  --back-end=<b>           One of 'asan', 'process', 'dll' or 'all'.\n"
+    "                           Defaults to 'asan'.\n"
+    "  --heap-dll=<path>        The custom heap DLL, required by the 'dll'\n"
+    "                           back end. It must export GetProcessHeap,\n"
+    "                           HeapCreate, HeapDestroy, HeapAlloc, HeapFree\n"
+    "                           and HeapSize.\n"
+    "  --heap-dll-prefix=<p>    The prefix of the names of those exports,\n"
+    "                           e.g. 'asan_' for the SyzyASan runtime.\n"
+    "\n"
+    "SyzyASan configuration options:\n"
+    "  --heap=<h>               One of 'simple', 'large', 'zebra' or 'all'.\n"
+    "                           Defaults to 'all'.\n"
+    "  --quarantine=<q>         One of 'sharded', 'per-cpu' or 'all'.\n"
+    "                           Defaults to 'all'.\n"
+    "  --asan-options=<flags>   Additional runtime parameters, in the format\n"
+    "                           of the SYZYGY_ASAN_OPTIONS environment\n"
+    "                           variable. The quarantine size, for one, is\n"
+    "                           tuned here.\n"
+    "\n"
+    "  Latencies are in cycles as measured by rdtsc. For replayed stories,\n"
+    "  the percentiles are rounded up to a power of two.\n"
+    "\n";
+
+const char* kBackEndNames[] = { "asan", "process", "dll" };
+const char* kHeapNames[] = { "simple", "large", "zebra" };
+const char* kQuarantineNames[] = { "sharded", "per-cpu" };
+
+// Parses an optional numeric switch.
+// @param command_line The command line to parse.
+// @param name The name of the switch.
+// @param value Will receive the value of the switch, if present.
+// @returns true on success, false if the switch is malformed.
+template <typename T>
+bool ParseNumericSwitch(const base::CommandLine* command_line,
+                        const char* name,
+                        T* value) {
+  if (!command_line->HasSwitch(name))
+    return true;
+  uint64_t parsed = 0;
+  if (!base::StringToUint64(command_line->GetSwitchValueASCII(name),
+                            &parsed)) {
+    return false;
+  }
+  *value = static_cast<T>(parsed);
+  return static_cast<uint64_t>(*value) == parsed;
+}
+
+// Parses a configuration switch.
+// @param command_line The command line to parse.
+// @param name The name of the switch.
+// @param names The names of the configurations.
+// @param configurations Will receive the selected configurations.
+// @returns true on success, false if the switch is malformed.
+template <typename Configuration, size_t kCount>
+bool ParseConfigurationSwitch(const base::CommandLine* command_line,
+                              const char* name,
+                              const char* (&names)[kCount],
+                              std::vector<Configuration>* configurations) {
+  std::string value = "all";
+  if (command_line->HasSwitch(name))
+    value = command_line->GetSwitchValueASCII(name);
+
+  configurations->clear();
+  for (size_t i = 0; i < kCount; ++i) {
+    if (value == "all" || value == names[i])
+      configurations->push_back(static_cast<Configuration>(i));
+  }
+  return !configurations->empty();
+}
+
+// Prints the non-empty buckets of a latency histogram.
+void PrintHistogram(FILE* out, const LatencyDistribution& distribution) {
+  for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+    if (distribution.histogram[i] == 0)
+      continue;
+    uint64_t upper_bound = i == 0 ? 0 : (1ull << i) - 1;
+    ::fprintf(out, "    <=%llu: %llu\n", upper_bound,
+              distribution.histogram[i]);
+  }
+}
+
+}  // namespace
+
+HeapManagerBenchmarkApp::HeapManagerBenchmarkApp()
+    : application::AppImplBase("HeapManagerBenchmark") {
+  ::common::SetDefaultAsanParameters(&parameters_);
+}
+
+bool HeapManagerBenchmarkApp::ParseCommandLine(
+    const base::CommandLine* command_line) {
+  DCHECK_NE(static_cast<const base::CommandLine*>(nullptr), command_line);
+
+  if (command_line->HasSwitch("help"))
+    return Usage(command_line, "");
+
+  if (!ParseNumericSwitch(command_line, "threads", &workload_.thread_count) ||
+      workload_.thread_count == 0) {
+    return Usage(command_line, "Invalid number of threads.");
+  }
+  if (!ParseNumericSwitch(command_line, "operations",
+                          &workload_.operation_count)) {
+    return Usage(command_line, "Invalid number of operations.");
+  }
+  if (!ParseNumericSwitch(command_line, "live-allocations",
+                          &workload_.live_allocation_count) ||
+      workload_.live_allocation_count == 0) {
+    return Usage(command_line, "Invalid number of live allocations.");
+  }
+  if (!ParseNumericSwitch(command_line, "min-size", &workload_.min_size) ||
+      !ParseNumericSwitch(command_line, "max-size", &workload_.max_size) ||
+      workload_.min_size > workload_.max_size) {
+    return Usage(command_line, "Invalid allocation size range.");
+  }
+
+  if (command_line->HasSwitch("size-distribution")) {
+    std::string distribution =
+        command_line->GetSwitchValueASCII("size-distribution");
+    if (distribution == "uniform") {
+      workload_.size_distribution = kUniformSizeDistribution;
+    } else if (distribution == "log-uniform") {
+      workload_.size_distribution = kLogUniformSizeDistribution;
+    } else {
+      return Usage(command_line, "Invalid size distribution.");
+    }
+  }
+
+  replay_path_ = command_line->GetSwitchValuePath("replay");
+
+  if (!command_line->HasSwitch("back-end")) {
+    back_ends_.assign(1, kAsanBackEnd);
+  } else if (!ParseConfigurationSwitch(command_line, "back-end",
+                                       kBackEndNames, &back_ends_)) {
+    return Usage(command_line, "Invalid back end.");
+  }
+  heap_dll_path_ = command_line->GetSwitchValuePath("heap-dll");
+  heap_dll_prefix_ = command_line->GetSwitchValueASCII("heap-dll-prefix");
+  if (heap_dll_path_.empty() &&
+      std::find(back_ends_.begin(), back_ends_.end(), kHeapDllBackEnd) !=
+          back_ends_.end()) {
+    return Usage(command_line, "The 'dll' back end requires --heap-dll.");
+  }
+
+  if (!ParseConfigurationSwitch(command_line, "heap", kHeapNames, &heaps_))
+    return Usage(command_line, "Invalid heap configuration.");
+  if (!ParseConfigurationSwitch(command_line, "quarantine", kQuarantineNames,
+                                &quarantines_)) {
+    return Usage(command_line, "Invalid quarantine configuration.");
+  }
+
+  if (command_line->HasSwitch("asan-options")) {
+    std::wstring options = command_line->GetSwitchValueNative("asan-options");
+    if (!::common::ParseAsanParameters(options, &parameters_))
+      return Usage(command_line, "Invalid ASan options.");
+  }
+
+  return true;
+}
+
+int HeapManagerBenchmarkApp::Run() {
+  for (BackEnd back_end : back_ends_) {
+    if (back_end != kAsanBackEnd) {
+      HeapManagerBenchmark benchmark;
+      bool initialized = false;
+      if (back_end == kProcessHeapBackEnd) {
+        initialized = benchmark.InitProcessHeap();
+      } else {
+        DCHECK_EQ(kHeapDllBackEnd, back_end);
+        initialized = benchmark.InitHeapDll(heap_dll_path_, heap_dll_prefix_);
+      }
+      if (!initialized ||
+          !RunBenchmark(&benchmark,
+                        base::StringPrintf("back-end=%s",
+                                           kBackEndNames[back_end]))) {
+        return kError;
+      }
+      continue;
+    }
+
+    for (HeapConfiguration heap : heaps_) {
+      for (QuarantineConfiguration quarantine : quarantines_) {
+        ::common::InflatedAsanParameters parameters = parameters_;
+        ApplyConfiguration(heap, quarantine, &parameters);
+
+        // Each configuration gets a heap manager of its own, so that no state
+        // carries over from one to the next.
+        HeapManagerBenchmark benchmark;
+        if (!benchmark.Init(parameters) ||
+            !RunBenchmark(&benchmark,
+                          base::StringPrintf("back-end=asan heap=%s "
+                                             "quarantine=%s",
+                                             kHeapNames[heap],
+                                             kQuarantineNames[quarantine]))) {
+          return kError;
+        }
+      }
+    }
+  }
+
+  return kSuccess;
+}
+
+bool HeapManagerBenchmarkApp::RunBenchmark(HeapManagerBenchmark* benchmark,
+                                           const std::string& name) {
+  DCHECK_NE(static_cast<HeapManagerBenchmark*>(nullptr), benchmark);
+
+  BenchmarkResults results = {};
+  bool success = false;
+  if (replay_path_.empty()) {
+    success = benchmark->RunSyntheticWorkload(workload_, &results);
+  } else {
+    success = benchmark->ReplayStories(replay_path_, &results);
+  }
+  if (!success) {
+    LOG(ERROR) << "Benchmark failed for " << name << ".";
+    return false;
+  }
+
+  PrintResults(name, results);
+  return true;
+}
+
+void HeapManagerBenchmarkApp::ApplyConfiguration(
+    HeapConfiguration heap,
+    QuarantineConfiguration quarantine,
+    ::common::AsanParameters* parameters) {
+  DCHECK_NE(static_cast<::common::AsanParameters*>(nullptr), parameters);
+
+  parameters->enable_large_block_heap = heap == kLargeBlockHeapConfiguration;
+  parameters->enable_zebra_block_heap = heap == kZebraBlockHeapConfiguration;
+  if (heap == kLargeBlockHeapConfiguration)
+    parameters->large_allocation_threshold = 0;
+
+  parameters->enable_per_cpu_quarantine =
+      quarantine == kPerCpuQuarantineConfiguration;
+}
+
+void HeapManagerBenchmarkApp::PrintResults(const std::string& name,
+                                           const BenchmarkResults& results) {
+  ::fprintf(out(), "%s\n", name.c_str());
+  ::fprintf(out(), "  Throughput: %.0f operations/s (%.3f s)\n",
+            results.GetThroughput(), results.elapsed.InSecondsF());
+  ::fprintf(out(), "  Allocations: count=%llu mean=%llu p50=%llu p99=%llu\n",
+            results.allocation_latency.count, results.allocation_latency.mean,
+            results.allocation_latency.p50, results.allocation_latency.p99);
+  PrintHistogram(out(), results.allocation_latency);
+  ::fprintf(out(), "  Frees: count=%llu mean=%llu p50=%llu p99=%llu\n",
+            results.free_latency.count, results.free_latency.mean,
+            results.free_latency.p50, results.free_latency.p99);
+  PrintHistogram(out(), results.free_latency);
+  ::fprintf(out(), "  Memory: requested=%llu KB private=%llu KB "
+            "overhead=%.2fx fragmentation=%.1f%%\n",
+            results.peak_requested_bytes / 1024,
+            results.peak_private_bytes / 1024,
+            results.GetMemoryOverhead(),
+            results.GetFragmentation() * 100.0);
+
+  // The remaining statistics are only known for the SyzyASan heap manager.
+  const AsanRuntimeStatistics& statistics = results.statistics;
+  if (statistics.heap_count == 0)
+    return;
+  ::fprintf(out(), "  Quarantine: pushes=%u pops=%u trims=%u\n",
+            statistics.quarantine_pushes, statistics.quarantine_pops,
+            statistics.quarantine_trims);
+  ::fprintf(out(), "  Stack cache: hits=%u requests=%u\n",
+            statistics.stack_cache_hits, statistics.stack_cache_requests);
+  for (size_t i = 0; i < statistics.heap_count; ++i) {
+    const AsanHeapLockStatistics& lock = statistics.heaps[i];
+    ::fprintf(out(), "  Heap lock: type=%u acquisitions=%u contentions=%u "
+              "wait=%llu us\n",
+              lock.heap_type, lock.acquisitions, lock.contentions,
+              lock.wait_time_us);
+  }
+}
+
+bool HeapManagerBenchmarkApp::Usage(const base::CommandLine* command_line,
+                                    const base::StringPiece& message) const {
+  if (!message.empty()) {
+    ::fwrite(message.data(), 1, message.length(), err());
+    ::fprintf(err(), "\n\n");
+  }
+
+  ::fprintf(err(),
+            kUsageFormatStr,
+            command_line->GetProgram().BaseName().value().c_str());
+
+  return false;
+}
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
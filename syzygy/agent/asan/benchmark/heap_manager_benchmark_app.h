@@ -0,0 +1,118 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Defines the HeapManagerBenchmarkApp class, which implements a command-line
+// tool running HeapManagerBenchmark against a set of heap back ends: the
+// SyzyASan heap manager, in a matrix of heap and quarantine configurations,
+// the Windows heaps and a custom heap DLL.
+
+#ifndef SYZYGY_AGENT_ASAN_BENCHMARK_HEAP_MANAGER_BENCHMARK_APP_H_
+#define SYZYGY_AGENT_ASAN_BENCHMARK_HEAP_MANAGER_BENCHMARK_APP_H_
+
+#include <string>
+#include <vector>
+
+#include "base/command_line.h"
+#include "base/files/file_path.h"
+#include "base/strings/string_piece.h"
+#include "syzygy/agent/asan/benchmark/heap_manager_benchmark.h"
+#include "syzygy/application/application.h"
+#include "syzygy/common/asan_parameters.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+// Implements the "heap_manager_benchmark" command-line application.
+//
+// Refer to kUsageFormatStr (referenced from HeapManagerBenchmarkApp::Usage())
+// for usage information.
+class HeapManagerBenchmarkApp : public application::AppImplBase {
+ public:
+  // The heap back ends that can be benchmarked.
+  enum BackEnd {
+    // The SyzyASan heap manager, in each of the selected configurations.
+    kAsanBackEnd,
+    // The Windows heaps.
+    kProcessHeapBackEnd,
+    // The heaps of a custom heap DLL.
+    kHeapDllBackEnd,
+  };
+
+  // The heap configurations that can be benchmarked.
+  enum HeapConfiguration {
+    // Everything is served by the simple block heaps.
+    kSimpleHeapConfiguration,
+    // Everything is served by the large block heap.
+    kLargeBlockHeapConfiguration,
+    // Everything that fits is served by the zebra block heap.
+    kZebraBlockHeapConfiguration,
+  };
+
+  // The quarantine configurations that can be benchmarked.
+  enum QuarantineConfiguration {
+    kShardedQuarantineConfiguration,
+    kPerCpuQuarantineConfiguration,
+  };
+
+  HeapManagerBenchmarkApp();
+
+  // @name Implementation of the AppImplBase interface.
+  // @{
+  bool ParseCommandLine(const base::CommandLine* command_line);
+  int Run();
+  // @}
+
+ protected:
+  // Adjusts parameters to select a configuration.
+  // @param heap The heap configuration to select.
+  // @param quarantine The quarantine configuration to select.
+  // @param parameters The parameters to adjust.
+  static void ApplyConfiguration(HeapConfiguration heap,
+                                 QuarantineConfiguration quarantine,
+                                 ::common::AsanParameters* parameters);
+
+  // Runs the workload against a back end, and prints the results.
+  // @param benchmark The benchmark of the back end, initialized.
+  // @param name The name of the back end, and of its configuration.
+  // @returns true on success, false otherwise.
+  bool RunBenchmark(HeapManagerBenchmark* benchmark, const std::string& name);
+
+  // Prints the results of the benchmark of a back end.
+  void PrintResults(const std::string& name, const BenchmarkResults& results);
+
+  // @name Utility members.
+  // @{
+  bool Usage(const base::CommandLine* command_line,
+             const base::StringPiece& message) const;
+  // @}
+
+  // @name Command-line parameters.
+  // @{
+  SyntheticWorkload workload_;
+  base::FilePath replay_path_;
+  std::vector<BackEnd> back_ends_;
+  base::FilePath heap_dll_path_;
+  std::string heap_dll_prefix_;
+  std::vector<HeapConfiguration> heaps_;
+  std::vector<QuarantineConfiguration> quarantines_;
+  ::common::InflatedAsanParameters parameters_;
+  // @}
+};
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_BENCHMARK_HEAP_MANAGER_BENCHMARK_APP_H_
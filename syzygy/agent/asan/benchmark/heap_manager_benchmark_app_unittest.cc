@@ -0,0 +1,212 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/benchmark/heap_manager_benchmark_app.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/common/unittest_util.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+namespace {
+
+class TestHeapManagerBenchmarkApp : public HeapManagerBenchmarkApp {
+ public:
+  using HeapManagerBenchmarkApp::ApplyConfiguration;
+  using HeapManagerBenchmarkApp::back_ends_;
+  using HeapManagerBenchmarkApp::heap_dll_path_;
+  using HeapManagerBenchmarkApp::heap_dll_prefix_;
+  using HeapManagerBenchmarkApp::heaps_;
+  using HeapManagerBenchmarkApp::parameters_;
+  using HeapManagerBenchmarkApp::quarantines_;
+  using HeapManagerBenchmarkApp::replay_path_;
+  using HeapManagerBenchmarkApp::workload_;
+};
+
+typedef application::Application<TestHeapManagerBenchmarkApp> TestApp;
+
+class HeapManagerBenchmarkAppTest : public testing::ApplicationTestBase {
+ public:
+  typedef testing::ApplicationTestBase Super;
+
+  HeapManagerBenchmarkAppTest()
+      : cmd_line_(base::FilePath(L"syzyasan_heap_benchmark.exe")),
+        test_impl_(test_app_.implementation()) {
+  }
+
+  void SetUp() override {
+    Super::SetUp();
+
+    // Several of the tests generate (deliberate) usage errors that would
+    // otherwise clutter the unittest output.
+    logging::SetMinLogLevel(logging::LOG_FATAL);
+
+    test_app_.set_command_line(&cmd_line_);
+    test_app_.set_in(in());
+    test_app_.set_out(out());
+    test_app_.set_err(err());
+  }
+
+  // Stashes the current log-level before each test instance and restores it
+  // after each test completes.
+  testing::ScopedLogLevelSaver log_level_saver;
+
+  base::CommandLine cmd_line_;
+  TestApp test_app_;
+  TestApp::Implementation& test_impl_;
+};
+
+}  // namespace
+
+TEST_F(HeapManagerBenchmarkAppTest, GetHelp) {
+  cmd_line_.AppendSwitch("help");
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(HeapManagerBenchmarkAppTest, ParseEmptyCommandLine) {
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+
+  SyntheticWorkload default_workload;
+  EXPECT_EQ(default_workload.thread_count, test_impl_.workload_.thread_count);
+  EXPECT_EQ(default_workload.operation_count,
+            test_impl_.workload_.operation_count);
+  EXPECT_TRUE(test_impl_.replay_path_.empty());
+  ASSERT_EQ(1u, test_impl_.back_ends_.size());
+  EXPECT_EQ(HeapManagerBenchmarkApp::kAsanBackEnd, test_impl_.back_ends_[0]);
+  EXPECT_TRUE(test_impl_.heap_dll_path_.empty());
+  EXPECT_EQ(3u, test_impl_.heaps_.size());
+  EXPECT_EQ(2u, test_impl_.quarantines_.size());
+
+  // The defaults of the runtime are used.
+  EXPECT_EQ(::common::kDefaultQuarantineSize,
+            test_impl_.parameters_.quarantine_size);
+}
+
+TEST_F(HeapManagerBenchmarkAppTest, ParseFullCommandLine) {
+  cmd_line_.AppendSwitchASCII("threads", "4");
+  cmd_line_.AppendSwitchASCII("operations", "1234");
+  cmd_line_.AppendSwitchASCII("live-allocations", "56");
+  cmd_line_.AppendSwitchASCII("min-size", "8");
+  cmd_line_.AppendSwitchASCII("max-size", "64");
+  cmd_line_.AppendSwitchASCII("size-distribution", "uniform");
+  cmd_line_.AppendSwitchASCII("heap", "zebra");
+  cmd_line_.AppendSwitchASCII("quarantine", "per-cpu");
+  cmd_line_.AppendSwitchASCII("asan-options", "--quarantine_size=1024");
+  cmd_line_.AppendSwitchPath("replay", base::FilePath(L"stories.bin"));
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+
+  EXPECT_EQ(4u, test_impl_.workload_.thread_count);
+  EXPECT_EQ(1234u, test_impl_.workload_.operation_count);
+  EXPECT_EQ(56u, test_impl_.workload_.live_allocation_count);
+  EXPECT_EQ(8u, test_impl_.workload_.min_size);
+  EXPECT_EQ(64u, test_impl_.workload_.max_size);
+  EXPECT_EQ(kUniformSizeDistribution, test_impl_.workload_.size_distribution);
+  ASSERT_EQ(1u, test_impl_.heaps_.size());
+  EXPECT_EQ(HeapManagerBenchmarkApp::kZebraBlockHeapConfiguration,
+            test_impl_.heaps_[0]);
+  ASSERT_EQ(1u, test_impl_.quarantines_.size());
+  EXPECT_EQ(HeapManagerBenchmarkApp::kPerCpuQuarantineConfiguration,
+            test_impl_.quarantines_[0]);
+  EXPECT_EQ(1024u, test_impl_.parameters_.quarantine_size);
+  EXPECT_EQ(base::FilePath(L"stories.bin"), test_impl_.replay_path_);
+}
+
+TEST_F(HeapManagerBenchmarkAppTest, ParseBackEnds) {
+  cmd_line_.AppendSwitchASCII("back-end", "all");
+  cmd_line_.AppendSwitchPath("heap-dll", base::FilePath(L"heap.dll"));
+  cmd_line_.AppendSwitchASCII("heap-dll-prefix", "my_");
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+
+  ASSERT_EQ(3u, test_impl_.back_ends_.size());
+  EXPECT_EQ(HeapManagerBenchmarkApp::kAsanBackEnd, test_impl_.back_ends_[0]);
+  EXPECT_EQ(HeapManagerBenchmarkApp::kProcessHeapBackEnd,
+            test_impl_.back_ends_[1]);
+  EXPECT_EQ(HeapManagerBenchmarkApp::kHeapDllBackEnd,
+            test_impl_.back_ends_[2]);
+  EXPECT_EQ(base::FilePath(L"heap.dll"), test_impl_.heap_dll_path_);
+  EXPECT_EQ("my_", test_impl_.heap_dll_prefix_);
+}
+
+TEST_F(HeapManagerBenchmarkAppTest, ParseInvalidCommandLines) {
+  const std::pair<const char*, const char*> kInvalidSwitches[] = {
+      { "threads", "0" },
+      { "threads", "foo" },
+      { "live-allocations", "0" },
+      { "size-distribution", "gaussian" },
+      { "heap", "foo" },
+      { "quarantine", "bar" },
+      { "back-end", "foo" },
+      // The 'dll' back end requires --heap-dll.
+      { "back-end", "dll" },
+  };
+  for (const auto& invalid_switch : kInvalidSwitches) {
+    base::CommandLine cmd_line(base::FilePath(L"syzyasan_heap_benchmark.exe"));
+    cmd_line.AppendSwitchASCII(invalid_switch.first, invalid_switch.second);
+    EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line));
+  }
+
+  cmd_line_.AppendSwitchASCII("min-size", "100");
+  cmd_line_.AppendSwitchASCII("max-size", "10");
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(HeapManagerBenchmarkAppTest, ApplyConfiguration) {
+  ::common::InflatedAsanParameters parameters;
+  ::common::SetDefaultAsanParameters(&parameters);
+
+  TestHeapManagerBenchmarkApp::ApplyConfiguration(
+      HeapManagerBenchmarkApp::kLargeBlockHeapConfiguration,
+      HeapManagerBenchmarkApp::kShardedQuarantineConfiguration,
+      &parameters);
+  EXPECT_TRUE(parameters.enable_large_block_heap);
+  EXPECT_FALSE(parameters.enable_zebra_block_heap);
+  EXPECT_EQ(0u, parameters.large_allocation_threshold);
+  EXPECT_FALSE(parameters.enable_per_cpu_quarantine);
+
+  TestHeapManagerBenchmarkApp::ApplyConfiguration(
+      HeapManagerBenchmarkApp::kZebraBlockHeapConfiguration,
+      HeapManagerBenchmarkApp::kPerCpuQuarantineConfiguration,
+      &parameters);
+  EXPECT_FALSE(parameters.enable_large_block_heap);
+  EXPECT_TRUE(parameters.enable_zebra_block_heap);
+  EXPECT_TRUE(parameters.enable_per_cpu_quarantine);
+
+  TestHeapManagerBenchmarkApp::ApplyConfiguration(
+      HeapManagerBenchmarkApp::kSimpleHeapConfiguration,
+      HeapManagerBenchmarkApp::kShardedQuarantineConfiguration,
+      &parameters);
+  EXPECT_FALSE(parameters.enable_large_block_heap);
+  EXPECT_FALSE(parameters.enable_zebra_block_heap);
+}
+
+TEST_F(HeapManagerBenchmarkAppTest, RunSmallWorkload) {
+  cmd_line_.AppendSwitchASCII("operations", "100");
+  cmd_line_.AppendSwitchASCII("live-allocations", "10");
+  ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(0, test_impl_.Run());
+}
+
+TEST_F(HeapManagerBenchmarkAppTest, RunSmallWorkloadOnProcessHeap) {
+  cmd_line_.AppendSwitchASCII("operations", "100");
+  cmd_line_.AppendSwitchASCII("live-allocations", "10");
+  cmd_line_.AppendSwitchASCII("back-end", "process");
+  ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(0, test_impl_.Run());
+}
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,160 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/benchmark/heap_manager_benchmark.h"
+
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+namespace {
+
+class TestHeapManagerBenchmark : public HeapManagerBenchmark {
+ public:
+  using HeapManagerBenchmark::shadow_;
+};
+
+class HeapManagerBenchmarkTest : public testing::Test {
+ public:
+  void SetUp() override {
+    ::common::SetDefaultAsanParameters(&parameters_);
+
+    workload_.thread_count = 2;
+    workload_.operation_count = 1000;
+    workload_.live_allocation_count = 16;
+    workload_.min_size = 1;
+    workload_.max_size = 256;
+  }
+
+  ::common::AsanParameters parameters_;
+  SyntheticWorkload workload_;
+};
+
+}  // namespace
+
+TEST_F(HeapManagerBenchmarkTest, RunSyntheticWorkload) {
+  TestHeapManagerBenchmark benchmark;
+  ASSERT_TRUE(benchmark.Init(parameters_));
+  ASSERT_NE(static_cast<heap_managers::BlockHeapManager*>(nullptr),
+            benchmark.heap_manager());
+
+  BenchmarkResults results = {};
+  ASSERT_TRUE(benchmark.RunSyntheticWorkload(workload_, &results));
+
+  uint64_t operation_count =
+      workload_.thread_count * workload_.operation_count;
+  EXPECT_EQ(operation_count, results.allocation_latency.count);
+  EXPECT_LE(results.allocation_latency.p50, results.allocation_latency.p99);
+  // The first allocation of each slot doesn't replace anything.
+  EXPECT_GE(operation_count, results.free_latency.count);
+  EXPECT_LE(operation_count -
+                workload_.thread_count * workload_.live_allocation_count,
+            results.free_latency.count);
+  EXPECT_LE(results.free_latency.p50, results.free_latency.p99);
+
+  EXPECT_LT(0u, results.peak_requested_bytes);
+  EXPECT_GE(workload_.thread_count * workload_.live_allocation_count *
+                workload_.max_size,
+            results.peak_requested_bytes);
+  EXPECT_LT(0.0, results.GetThroughput());
+
+  // The remaining allocations are freed once the timed part is over, so the
+  // heap manager has seen as many frees as allocations.
+  EXPECT_EQ(sizeof(results.statistics), results.statistics.size);
+  EXPECT_EQ(operation_count, results.statistics.allocations);
+  EXPECT_EQ(operation_count, results.statistics.frees);
+  EXPECT_EQ(operation_count, results.statistics.quarantine_pushes);
+}
+
+TEST_F(HeapManagerBenchmarkTest, UniformSizeDistribution) {
+  workload_.size_distribution = kUniformSizeDistribution;
+  workload_.min_size = 64;
+  workload_.max_size = 127;
+
+  TestHeapManagerBenchmark benchmark;
+  ASSERT_TRUE(benchmark.Init(parameters_));
+  BenchmarkResults results = {};
+  ASSERT_TRUE(benchmark.RunSyntheticWorkload(workload_, &results));
+
+  // All of the allocations land in the [64, 128) size class.
+  EXPECT_EQ(results.statistics.allocations,
+            results.statistics.allocation_size_classes[7]);
+}
+
+TEST_F(HeapManagerBenchmarkTest, RunSyntheticWorkloadOnProcessHeap) {
+  TestHeapManagerBenchmark benchmark;
+  ASSERT_TRUE(benchmark.InitProcessHeap());
+  EXPECT_EQ(static_cast<heap_managers::BlockHeapManager*>(nullptr),
+            benchmark.heap_manager());
+  ASSERT_NE(static_cast<HeapManagerInterface*>(nullptr), benchmark.back_end());
+
+  BenchmarkResults results = {};
+  ASSERT_TRUE(benchmark.RunSyntheticWorkload(workload_, &results));
+
+  uint64_t operation_count =
+      workload_.thread_count * workload_.operation_count;
+  EXPECT_EQ(operation_count, results.allocation_latency.count);
+  uint64_t histogram_count = 0;
+  for (size_t i = 0; i < kLatencyBucketCount; ++i)
+    histogram_count += results.allocation_latency.histogram[i];
+  EXPECT_EQ(operation_count, histogram_count);
+  EXPECT_LT(0u, results.peak_requested_bytes);
+
+  // The heap manager statistics are unknown for the Windows heaps.
+  EXPECT_EQ(sizeof(results.statistics), results.statistics.size);
+  EXPECT_EQ(0u, results.statistics.allocations);
+}
+
+TEST_F(HeapManagerBenchmarkTest, InitHeapDllFailsForMissingDll) {
+  TestHeapManagerBenchmark benchmark;
+  EXPECT_FALSE(benchmark.InitHeapDll(
+      base::FilePath(L"C:\\this\\path\\does\\not\\exist.dll"), ""));
+}
+
+TEST(GetLatencyBucketTest, Buckets) {
+  EXPECT_EQ(0u, GetLatencyBucket(0));
+  EXPECT_EQ(1u, GetLatencyBucket(1));
+  EXPECT_EQ(2u, GetLatencyBucket(2));
+  EXPECT_EQ(2u, GetLatencyBucket(3));
+  EXPECT_EQ(3u, GetLatencyBucket(4));
+  EXPECT_EQ(11u, GetLatencyBucket(1024));
+  EXPECT_EQ(kLatencyBucketCount - 1, GetLatencyBucket(~0ull));
+}
+
+TEST(BenchmarkResultsTest, GetFragmentation) {
+  BenchmarkResults results = {};
+  EXPECT_EQ(0.0, results.GetFragmentation());
+
+  results.peak_requested_bytes = 300;
+  results.peak_private_bytes = 400;
+  EXPECT_DOUBLE_EQ(0.25, results.GetFragmentation());
+
+  // The private bytes are sampled, and may miss the peak.
+  results.peak_private_bytes = 200;
+  EXPECT_EQ(0.0, results.GetFragmentation());
+}
+
+TEST_F(HeapManagerBenchmarkTest, ReplayMissingFileFails) {
+  TestHeapManagerBenchmark benchmark;
+  ASSERT_TRUE(benchmark.Init(parameters_));
+  BenchmarkResults results = {};
+  EXPECT_FALSE(benchmark.ReplayStories(
+      base::FilePath(L"C:\\this\\path\\does\\not\\exist.bin"), &results));
+}
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,155 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/benchmark/windows_heap_back_end.h"
+
+#include "base/logging.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+namespace {
+
+// Looks up an export of a custom heap DLL.
+// @param module The DLL.
+// @param prefix The prefix of the names of its heap API exports.
+// @param name The name of the heap API function.
+// @param function Will receive the address of the export.
+// @returns true on success, false otherwise.
+template <typename Function>
+bool GetHeapFunction(HMODULE module,
+                     const std::string& prefix,
+                     const char* name,
+                     Function* function) {
+  DCHECK_NE(static_cast<HMODULE>(nullptr), module);
+  DCHECK_NE(static_cast<const char*>(nullptr), name);
+  DCHECK_NE(static_cast<Function*>(nullptr), function);
+
+  std::string export_name = prefix + name;
+  *function = reinterpret_cast<Function>(
+      ::GetProcAddress(module, export_name.c_str()));
+  if (*function == nullptr) {
+    LOG(ERROR) << "The heap DLL doesn't export " << export_name << ".";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+WindowsHeapBackEnd::WindowsHeapBackEnd()
+    : functions_(), process_heap_(0), module_(nullptr) {
+}
+
+WindowsHeapBackEnd::~WindowsHeapBackEnd() {
+  if (module_ != nullptr)
+    ::FreeLibrary(module_);
+}
+
+bool WindowsHeapBackEnd::InitProcessHeap() {
+  HeapFunctions functions = {};
+  functions.get_process_heap = &::GetProcessHeap;
+  functions.heap_create = &::HeapCreate;
+  functions.heap_destroy = &::HeapDestroy;
+  functions.heap_alloc = &::HeapAlloc;
+  functions.heap_free = &::HeapFree;
+  functions.heap_size = &::HeapSize;
+  return Init(functions);
+}
+
+bool WindowsHeapBackEnd::InitHeapDll(const base::FilePath& path,
+                                     const std::string& prefix) {
+  DCHECK_EQ(static_cast<HMODULE>(nullptr), module_);
+
+  module_ = ::LoadLibrary(path.value().c_str());
+  if (module_ == nullptr) {
+    LOG(ERROR) << "Failed to load \"" << path.value() << "\".";
+    return false;
+  }
+
+  HeapFunctions functions = {};
+  if (!GetHeapFunction(module_, prefix, "GetProcessHeap",
+                       &functions.get_process_heap) ||
+      !GetHeapFunction(module_, prefix, "HeapCreate",
+                       &functions.heap_create) ||
+      !GetHeapFunction(module_, prefix, "HeapDestroy",
+                       &functions.heap_destroy) ||
+      !GetHeapFunction(module_, prefix, "HeapAlloc", &functions.heap_alloc) ||
+      !GetHeapFunction(module_, prefix, "HeapFree", &functions.heap_free) ||
+      !GetHeapFunction(module_, prefix, "HeapSize", &functions.heap_size)) {
+    return false;
+  }
+  return Init(functions);
+}
+
+WindowsHeapBackEnd::HeapId WindowsHeapBackEnd::CreateHeap() {
+  return reinterpret_cast<HeapId>(functions_.heap_create(0, 0, 0));
+}
+
+bool WindowsHeapBackEnd::DestroyHeap(HeapId heap) {
+  return functions_.heap_destroy(reinterpret_cast<HANDLE>(heap)) == TRUE;
+}
+
+void* WindowsHeapBackEnd::Allocate(HeapId heap, uint32_t bytes) {
+  return functions_.heap_alloc(reinterpret_cast<HANDLE>(heap), 0, bytes);
+}
+
+bool WindowsHeapBackEnd::Free(HeapId heap, void* alloc) {
+  return functions_.heap_free(reinterpret_cast<HANDLE>(heap), 0, alloc) ==
+         TRUE;
+}
+
+uint32_t WindowsHeapBackEnd::Size(HeapId heap, const void* alloc) {
+  SIZE_T size = functions_.heap_size(reinterpret_cast<HANDLE>(heap), 0, alloc);
+  if (size == static_cast<SIZE_T>(-1))
+    return 0;
+  return static_cast<uint32_t>(size);
+}
+
+// The replayed reallocations go through Allocate and Free, so that the back
+// ends are compared on the same operations.
+bool WindowsHeapBackEnd::ResizeInPlace(HeapId heap,
+                                       void* alloc,
+                                       uint32_t bytes) {
+  return false;
+}
+
+// The benchmarks never lock the heaps, and the heap API of a custom DLL
+// needn't offer a way to.
+void WindowsHeapBackEnd::Lock(HeapId heap) {
+}
+
+void WindowsHeapBackEnd::Unlock(HeapId heap) {
+}
+
+void WindowsHeapBackEnd::BestEffortLockAll() {
+}
+
+void WindowsHeapBackEnd::UnlockAll() {
+}
+
+bool WindowsHeapBackEnd::Init(const HeapFunctions& functions) {
+  functions_ = functions;
+  process_heap_ = reinterpret_cast<HeapId>(functions_.get_process_heap());
+  if (process_heap_ == 0) {
+    LOG(ERROR) << "Failed to get the process heap.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,102 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares WindowsHeapBackEnd, which exposes an implementation of the Windows
+// heap API through HeapManagerInterface, so that HeapManagerBenchmark can run
+// the same workloads against it as against the SyzyASan heap manager. The
+// heap API is either the one of kernel32, or one exported by a custom heap
+// DLL.
+
+#ifndef SYZYGY_AGENT_ASAN_BENCHMARK_WINDOWS_HEAP_BACK_END_H_
+#define SYZYGY_AGENT_ASAN_BENCHMARK_WINDOWS_HEAP_BACK_END_H_
+
+#include <windows.h>
+
+#include <string>
+
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "syzygy/agent/asan/heap_manager.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+// A heap manager forwarding to an implementation of the Windows heap API. The
+// heap IDs are the heap handles.
+class WindowsHeapBackEnd : public HeapManagerInterface {
+ public:
+  // The heap API functions forwarded to.
+  struct HeapFunctions {
+    HANDLE (WINAPI* get_process_heap)();
+    HANDLE (WINAPI* heap_create)(DWORD, SIZE_T, SIZE_T);
+    BOOL (WINAPI* heap_destroy)(HANDLE);
+    LPVOID (WINAPI* heap_alloc)(HANDLE, DWORD, SIZE_T);
+    BOOL (WINAPI* heap_free)(HANDLE, DWORD, LPVOID);
+    SIZE_T (WINAPI* heap_size)(HANDLE, DWORD, LPCVOID);
+  };
+
+  WindowsHeapBackEnd();
+  ~WindowsHeapBackEnd() override;
+
+  // Initializes this back end with the heap API of kernel32.
+  // @returns true on success, false otherwise.
+  bool InitProcessHeap();
+
+  // Initializes this back end with the heap API exported by a DLL. The DLL
+  // must export GetProcessHeap, HeapCreate, HeapDestroy, HeapAlloc, HeapFree
+  // and HeapSize, with the signatures of kernel32.
+  // @param path The path of the DLL.
+  // @param prefix The prefix of the names of the exports, e.g. "asan_" for
+  //     the SyzyASan runtime.
+  // @returns true on success, false otherwise.
+  bool InitHeapDll(const base::FilePath& path, const std::string& prefix);
+
+  // @returns the process heap of the heap API.
+  HeapId process_heap() const { return process_heap_; }
+
+  // @name HeapManagerInterface implementation.
+  // @{
+  HeapId CreateHeap() override;
+  bool DestroyHeap(HeapId heap) override;
+  void* Allocate(HeapId heap, uint32_t bytes) override;
+  bool Free(HeapId heap, void* alloc) override;
+  uint32_t Size(HeapId heap, const void* alloc) override;
+  bool ResizeInPlace(HeapId heap, void* alloc, uint32_t bytes) override;
+  void Lock(HeapId heap) override;
+  void Unlock(HeapId heap) override;
+  void BestEffortLockAll() override;
+  void UnlockAll() override;
+  // @}
+
+ protected:
+  // Initializes this back end with a set of heap functions.
+  // @returns true on success, false otherwise.
+  bool Init(const HeapFunctions& functions);
+
+  HeapFunctions functions_;
+  HeapId process_heap_;
+
+  // The custom heap DLL, if any.
+  HMODULE module_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WindowsHeapBackEnd);
+};
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_BENCHMARK_WINDOWS_HEAP_BACK_END_H_
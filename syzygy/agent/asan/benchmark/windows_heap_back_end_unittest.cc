@@ -0,0 +1,73 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/benchmark/windows_heap_back_end.h"
+
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+namespace benchmark {
+
+namespace {
+
+typedef WindowsHeapBackEnd::HeapId HeapId;
+
+// Exercises the heaps of an initialized back end.
+void TestHeaps(WindowsHeapBackEnd* back_end) {
+  HeapId heap = back_end->CreateHeap();
+  ASSERT_NE(0u, heap);
+
+  for (HeapId heap_id : { back_end->process_heap(), heap }) {
+    void* alloc = back_end->Allocate(heap_id, 100);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    EXPECT_EQ(100u, back_end->Size(heap_id, alloc));
+    EXPECT_TRUE(back_end->Free(heap_id, alloc));
+  }
+
+  EXPECT_TRUE(back_end->DestroyHeap(heap));
+}
+
+}  // namespace
+
+TEST(WindowsHeapBackEndTest, ProcessHeap) {
+  WindowsHeapBackEnd back_end;
+  ASSERT_TRUE(back_end.InitProcessHeap());
+  EXPECT_EQ(reinterpret_cast<HeapId>(::GetProcessHeap()),
+            back_end.process_heap());
+  ASSERT_NO_FATAL_FAILURE(TestHeaps(&back_end));
+}
+
+TEST(WindowsHeapBackEndTest, HeapDll) {
+  // Kernel32 exports the heap API without a prefix.
+  WindowsHeapBackEnd back_end;
+  ASSERT_TRUE(back_end.InitHeapDll(base::FilePath(L"kernel32.dll"), ""));
+  EXPECT_EQ(reinterpret_cast<HeapId>(::GetProcessHeap()),
+            back_end.process_heap());
+  ASSERT_NO_FATAL_FAILURE(TestHeaps(&back_end));
+}
+
+TEST(WindowsHeapBackEndTest, HeapDllFailures) {
+  WindowsHeapBackEnd missing_dll;
+  EXPECT_FALSE(missing_dll.InitHeapDll(
+      base::FilePath(L"C:\\this\\path\\does\\not\\exist.dll"), ""));
+
+  WindowsHeapBackEnd missing_exports;
+  EXPECT_FALSE(missing_exports.InitHeapDll(base::FilePath(L"kernel32.dll"),
+                                           "nonexistent_"));
+}
+
+}  // namespace benchmark
+}  // namespace asan
+}  // namespace agent
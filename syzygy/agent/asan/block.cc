@@ -14,10 +14,12 @@
 
 #include "syzygy/agent/asan/block.h"
 
+#include <intrin.h>
+
 #include <algorithm>
 
-#include "base/hash.h"
 #include "base/logging.h"
+#include "syzygy/agent/asan/block_checksum.h"
 #include "syzygy/agent/asan/runtime.h"
 #include "syzygy/agent/asan/shadow.h"
 #include "syzygy/agent/asan/stack_capture_cache.h"
@@ -113,6 +115,44 @@ uint32_t CombineUInt32IntoBlockChecksum(uint32_t val) {
 // a testing seam.
 OnExceptionCallback g_on_exception_callback;
 
+// An entry of the table used by BlockPlanLayoutCached. The sequence number is
+// odd while the entry is being written, and is bumped by 2 once it has been,
+// which allows readers to detect torn reads.
+struct BlockLayoutCacheEntry {
+  volatile LONG sequence;
+  LONG generation;
+  uint32_t chunk_size;
+  uint32_t alignment;
+  uint32_t size;
+  uint32_t min_left_redzone_size;
+  uint32_t min_right_redzone_size;
+  BlockLayout layout;
+};
+
+// The number of entries in the layout cache. Must be a power of 2.
+const size_t kBlockLayoutCacheSize = 256;
+
+// The layout cache. This is constant initialized so that it's usable before
+// the CRT is.
+BlockLayoutCacheEntry block_layout_cache[kBlockLayoutCacheSize];
+
+// The current generation of the layout cache. Entries of older generations
+// are ignored. This starts at 1 so that zeroed entries never match.
+volatile LONG block_layout_cache_generation = 1;
+
+size_t GetBlockLayoutCacheIndex(uint32_t chunk_size,
+                                uint32_t alignment,
+                                uint32_t size,
+                                uint32_t min_left_redzone_size,
+                                uint32_t min_right_redzone_size) {
+  uint32_t hash = size;
+  hash = hash * 31 + min_right_redzone_size;
+  hash = hash * 31 + min_left_redzone_size;
+  hash = hash * 31 + (chunk_size ^ alignment);
+  hash ^= hash >> 8;
+  return hash & (kBlockLayoutCacheSize - 1);
+}
+
 // An exception filter that catches access violations and out of bound accesses.
 // This also invokes the OnExceptionCallback if one has been provided.
 DWORD BadMemoryAccessFilter(EXCEPTION_POINTERS* e) {
@@ -227,6 +267,12 @@ BlockHeader* BlockGetHeaderFromBodyImpl(const BlockBody* const_body) {
 
 }  // namespace
 
+// Size classes grow by alternating factors of 1.5 and 1.33, which bounds the
+// internal fragmentation of a block rounded up to its size class to 50%.
+const uint32_t kBlockSizeClasses[kBlockSizeClassCount] = {
+    16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+    3072, 4096 };
+
 bool BlockPlanLayout(uint32_t chunk_size,
                      uint32_t alignment,
                      uint32_t size,
@@ -289,6 +335,64 @@ bool BlockPlanLayout(uint32_t chunk_size,
   return true;
 }
 
+bool BlockPlanLayoutCached(uint32_t chunk_size,
+                           uint32_t alignment,
+                           uint32_t size,
+                           uint32_t min_left_redzone_size,
+                           uint32_t min_right_redzone_size,
+                           BlockLayout* layout) {
+  DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
+
+  LONG generation = block_layout_cache_generation;
+  BlockLayoutCacheEntry* entry = &block_layout_cache[GetBlockLayoutCacheIndex(
+      chunk_size, alignment, size, min_left_redzone_size,
+      min_right_redzone_size)];
+
+  // The entry is read between two reads of its sequence number. x86 doesn't
+  // reorder loads with other loads, so only the compiler needs to be kept
+  // from doing so.
+  LONG sequence = entry->sequence;
+  if ((sequence & 1) == 0) {
+    bool hit = entry->generation == generation &&
+        entry->size == size &&
+        entry->min_right_redzone_size == min_right_redzone_size &&
+        entry->min_left_redzone_size == min_left_redzone_size &&
+        entry->chunk_size == chunk_size &&
+        entry->alignment == alignment;
+    BlockLayout cached_layout = entry->layout;
+    _ReadWriteBarrier();
+    if (hit && entry->sequence == sequence) {
+      *layout = cached_layout;
+      return true;
+    }
+  }
+
+  if (!BlockPlanLayout(chunk_size, alignment, size, min_left_redzone_size,
+                       min_right_redzone_size, layout)) {
+    return false;
+  }
+
+  // Update the entry, unless another thread is already doing so.
+  if ((sequence & 1) == 0 &&
+      ::InterlockedCompareExchange(&entry->sequence, sequence + 1,
+                                   sequence) == sequence) {
+    entry->generation = generation;
+    entry->size = size;
+    entry->min_right_redzone_size = min_right_redzone_size;
+    entry->min_left_redzone_size = min_left_redzone_size;
+    entry->chunk_size = chunk_size;
+    entry->alignment = alignment;
+    entry->layout = *layout;
+    ::InterlockedExchange(&entry->sequence, sequence + 2);
+  }
+
+  return true;
+}
+
+void BlockLayoutCacheInvalidate() {
+  ::InterlockedIncrement(&block_layout_cache_generation);
+}
+
 void BlockInitialize(const BlockLayout& layout,
                      void* allocation,
                      BlockInfo* block_info) {
@@ -431,21 +535,18 @@ void BlockSetChecksum(const BlockInfo& block_info) {
     case ALLOCATED_BLOCK:
     case QUARANTINED_FLOODED_BLOCK: {
       // Only checksum the header and trailer regions.
-      checksum = base::SuperFastHash(
-          reinterpret_cast<const char*>(block_info.header),
-          block_info.TotalHeaderSize());
-      checksum ^= base::SuperFastHash(
-          reinterpret_cast<const char*>(block_info.trailer_padding),
-          block_info.TotalTrailerSize());
+      checksum = internal::BlockChecksumHash(block_info.header,
+                                             block_info.TotalHeaderSize());
+      checksum ^= internal::BlockChecksumHash(block_info.trailer_padding,
+                                              block_info.TotalTrailerSize());
       break;
     }
 
     // The checksum is the calculated in the same way in these two cases.
     case QUARANTINED_BLOCK:
     case FREED_BLOCK: {
-      checksum = base::SuperFastHash(
-          reinterpret_cast<const char*>(block_info.header),
-          block_info.block_size);
+      checksum = internal::BlockChecksumHash(block_info.header,
+                                             block_info.block_size);
       break;
     }
   }
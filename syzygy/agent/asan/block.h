@@ -117,6 +117,13 @@ static constexpr size_t kBlockHeaderChecksumBits = 13;
 // The number of bits used to store the size of an allocation.
 static constexpr size_t kBlockBodySizeBits = 31;
 
+// The number of block size classes. These are shared by the heaps and caches
+// that segregate blocks by size.
+static constexpr size_t kBlockSizeClassCount = 17;
+
+// The block sizes associated with each size class, in increasing order.
+extern const uint32_t kBlockSizeClasses[kBlockSizeClassCount];
+
 // The state of an Asan block. These are in the order that reflects the typical
 // lifespan of an allocation.
 enum BlockState {
@@ -363,6 +370,28 @@ bool BlockPlanLayout(uint32_t chunk_size,
                      uint32_t min_right_redzone_size,
                      BlockLayout* layout);
 
+// Plans the layout of a block exactly like BlockPlanLayout, but memoizes the
+// planned layouts in a small process-wide table indexed by the planning
+// parameters. This is safe to call concurrently.
+// @param chunk_size See BlockPlanLayout.
+// @param alignment See BlockPlanLayout.
+// @param size See BlockPlanLayout.
+// @param min_left_redzone_size See BlockPlanLayout.
+// @param min_right_redzone_size See BlockPlanLayout.
+// @param layout The layout structure to be populated.
+// @returns true if the layout of the block is valid, false otherwise.
+bool BlockPlanLayoutCached(uint32_t chunk_size,
+                           uint32_t alignment,
+                           uint32_t size,
+                           uint32_t min_left_redzone_size,
+                           uint32_t min_right_redzone_size,
+                           BlockLayout* layout);
+
+// Discards the layouts memoized by BlockPlanLayoutCached. This should be
+// called when the redzone settings change, so that the table fills up with
+// the layouts that are now in use.
+void BlockLayoutCacheInvalidate();
+
 // Given a fresh allocation and a block layout, lays out and initializes the
 // given block. Initializes everything except for the allocation stack and the
 // checksum. Initializes the block to the ALLOCATED_BLOCK state, setting
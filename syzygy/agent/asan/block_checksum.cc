@@ -0,0 +1,111 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/block_checksum.h"
+
+#include <windows.h>
+#include <intrin.h>
+#include <nmmintrin.h>
+
+#include "base/hash.h"
+#include "base/logging.h"
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+namespace internal {
+
+namespace {
+
+// CPUID feature bits.
+const int kCpuidLeaf1EcxSse42 = 1 << 20;
+
+// The cached result of HasHardwareCrc32, or -1 if not yet computed. This is
+// constant initialized so that it's usable before the CRT is.
+volatile LONG has_hardware_crc32 = -1;
+
+bool DetectHardwareCrc32() {
+  int regs[4] = {};  // EAX, EBX, ECX and EDX.
+  ::__cpuid(regs, 0);
+  if (regs[0] < 1)
+    return false;
+  ::__cpuid(regs, 1);
+  return (regs[2] & kCpuidLeaf1EcxSse42) != 0;
+}
+
+}  // namespace
+
+bool HasHardwareCrc32() {
+  // This is racy, but all threads compute the same value.
+  LONG value = has_hardware_crc32;
+  if (value < 0) {
+    value = DetectHardwareCrc32() ? 1 : 0;
+    has_hardware_crc32 = value;
+  }
+  return value != 0;
+}
+
+uint32_t BlockChecksumHash(const void* data, size_t length) {
+  if (HasHardwareCrc32())
+    return BlockChecksumHashCrc32(data, length);
+  return BlockChecksumHashSoftware(data, length);
+}
+
+uint32_t BlockChecksumHashSoftware(const void* data, size_t length) {
+  return base::SuperFastHash(reinterpret_cast<const char*>(data),
+                             static_cast<int>(length));
+}
+
+uint32_t BlockChecksumHashCrc32(const void* data, size_t length) {
+  const uint8_t* cursor = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* cursor_end = cursor + length;
+  uint32_t crc = ~0u;
+
+  // Consume the unaligned head a byte at a time, then whole words.
+#if defined(_WIN64)
+  const uint8_t* cursor_aligned = ::common::AlignUp(cursor, sizeof(uint64_t));
+  const uint8_t* cursor_end_aligned =
+      ::common::AlignDown(cursor_end, sizeof(uint64_t));
+  if (cursor_aligned < cursor_end_aligned) {
+    for (; cursor != cursor_aligned; ++cursor)
+      crc = _mm_crc32_u8(crc, *cursor);
+    uint64_t crc64 = crc;
+    for (; cursor != cursor_end_aligned; cursor += sizeof(uint64_t)) {
+      crc64 = _mm_crc32_u64(crc64,
+                            *reinterpret_cast<const uint64_t*>(cursor));
+    }
+    crc = static_cast<uint32_t>(crc64);
+  }
+#else
+  const uint8_t* cursor_aligned = ::common::AlignUp(cursor, sizeof(uint32_t));
+  const uint8_t* cursor_end_aligned =
+      ::common::AlignDown(cursor_end, sizeof(uint32_t));
+  if (cursor_aligned < cursor_end_aligned) {
+    for (; cursor != cursor_aligned; ++cursor)
+      crc = _mm_crc32_u8(crc, *cursor);
+    for (; cursor != cursor_end_aligned; cursor += sizeof(uint32_t))
+      crc = _mm_crc32_u32(crc, *reinterpret_cast<const uint32_t*>(cursor));
+  }
+#endif
+
+  // Consume the tail.
+  for (; cursor != cursor_end; ++cursor)
+    crc = _mm_crc32_u8(crc, *cursor);
+
+  return ~crc;
+}
+
+}  // namespace internal
+}  // namespace asan
+}  // namespace agent
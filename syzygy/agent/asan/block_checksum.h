@@ -0,0 +1,54 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The hash functions used to compute block checksums. The SSE4.2 crc32
+// instruction is used when the processor supports it, otherwise this falls
+// back to base::SuperFastHash. The choice is made once per process, so the
+// checksums are only meaningful within the process that computed them.
+
+#ifndef SYZYGY_AGENT_ASAN_BLOCK_CHECKSUM_H_
+#define SYZYGY_AGENT_ASAN_BLOCK_CHECKSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace agent {
+namespace asan {
+namespace internal {
+
+// @returns true if the processor supports the SSE4.2 crc32 instruction. This
+//     is computed once and cached.
+bool HasHardwareCrc32();
+
+// Hashes a range of memory for use in a block checksum. This uses
+// BlockChecksumHashCrc32 if HasHardwareCrc32 returns true, and
+// BlockChecksumHashSoftware otherwise.
+// @param data The first byte to hash.
+// @param length The number of bytes to hash.
+// @returns the hash of the range.
+uint32_t BlockChecksumHash(const void* data, size_t length);
+
+// @name Implementations, exposed for unittesting.
+// @{
+// Hashes a range with base::SuperFastHash.
+uint32_t BlockChecksumHashSoftware(const void* data, size_t length);
+// Computes the CRC32-C of a range. The processor must support SSE4.2.
+uint32_t BlockChecksumHashCrc32(const void* data, size_t length);
+// @}
+
+}  // namespace internal
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_BLOCK_CHECKSUM_H_
@@ -0,0 +1,86 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/block_checksum.h"
+
+#include "base/hash.h"
+#include "base/rand_util.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+namespace internal {
+
+namespace {
+
+// A bitwise implementation of CRC32-C, used as a reference.
+uint32_t ReferenceCrc32c(const uint8_t* data, size_t length) {
+  uint32_t crc = ~0u;
+  for (size_t i = 0; i < length; ++i) {
+    crc ^= data[i];
+    for (size_t j = 0; j < 8; ++j)
+      crc = (crc >> 1) ^ (0x82F63B78 & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+
+}  // namespace
+
+TEST(BlockChecksumTest, HasHardwareCrc32) {
+  bool has_hardware_crc32 = HasHardwareCrc32();
+
+  // This is cached, so subsequent calls return the same value.
+  EXPECT_EQ(has_hardware_crc32, HasHardwareCrc32());
+}
+
+TEST(BlockChecksumTest, SoftwareHashIsSuperFastHash) {
+  const char kData[] = "The quick brown fox jumps over the lazy dog";
+  EXPECT_EQ(base::SuperFastHash(kData, sizeof(kData)),
+            BlockChecksumHashSoftware(kData, sizeof(kData)));
+}
+
+TEST(BlockChecksumTest, BlockChecksumHashUsesTheBestImplementation) {
+  const char kData[] = "The quick brown fox jumps over the lazy dog";
+  if (HasHardwareCrc32()) {
+    EXPECT_EQ(BlockChecksumHashCrc32(kData, sizeof(kData)),
+              BlockChecksumHash(kData, sizeof(kData)));
+  } else {
+    EXPECT_EQ(BlockChecksumHashSoftware(kData, sizeof(kData)),
+              BlockChecksumHash(kData, sizeof(kData)));
+  }
+}
+
+TEST(BlockChecksumTest, Crc32MatchesReference) {
+  if (!HasHardwareCrc32())
+    return;
+
+  // The standard CRC32-C check value.
+  const char kCheck[] = "123456789";
+  EXPECT_EQ(0xE3069283u, BlockChecksumHashCrc32(kCheck, 9));
+  EXPECT_EQ(0u, BlockChecksumHashCrc32(kCheck, 0));
+
+  // Try all head and tail alignments.
+  uint8_t buffer[256] = {};
+  base::RandBytes(buffer, sizeof(buffer));
+  for (size_t start = 0; start < 16; ++start) {
+    for (size_t length = 0; length < sizeof(buffer) - start; length += 7) {
+      EXPECT_EQ(ReferenceCrc32c(buffer + start, length),
+                BlockChecksumHashCrc32(buffer + start, length));
+    }
+  }
+}
+
+}  // namespace internal
+}  // namespace asan
+}  // namespace agent
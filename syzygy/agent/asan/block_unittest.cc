@@ -201,6 +201,35 @@ TEST_F(BlockTest, BlockPlanLayout) {
   EXPECT_FALSE(BlockPlanLayout(8, 8, 0xffffffff, 0, 0, &layout));
 }
 
+TEST_F(BlockTest, BlockPlanLayoutCached) {
+  static const uint32_t kChunkSizes[] = { 8, 16, 4096 };
+  static const uint32_t kRedzoneSizes[] = { 0, 32, 4096 };
+
+  // The memoized layouts must match the planned ones, whether they're planned
+  // for the first time or found in the cache.
+  for (size_t pass = 0; pass < 2; ++pass) {
+    for (uint32_t chunk_size : kChunkSizes) {
+      for (uint32_t redzone_size : kRedzoneSizes) {
+        for (uint32_t size = 0; size < 300; size += 3) {
+          BlockLayout expected_layout = {};
+          BlockLayout layout = {};
+          EXPECT_TRUE(BlockPlanLayout(chunk_size, 8, size, redzone_size,
+                                      redzone_size, &expected_layout));
+          EXPECT_TRUE(BlockPlanLayoutCached(chunk_size, 8, size, redzone_size,
+                                            redzone_size, &layout));
+          EXPECT_EQ(expected_layout, layout);
+        }
+      }
+    }
+    BlockLayoutCacheInvalidate();
+  }
+
+  // Invalid layouts are still rejected.
+  BlockLayout layout = {};
+  EXPECT_FALSE(BlockPlanLayoutCached(8, 8, 0xffffffff, 0, 0, &layout));
+  EXPECT_FALSE(BlockPlanLayoutCached(8, 8, 0xffffffff, 0, 0, &layout));
+}
+
 TEST_F(BlockTest, EndToEnd) {
   BlockLayout layout = {};
   BlockInfo block_info = {};
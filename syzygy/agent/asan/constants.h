@@ -34,6 +34,10 @@ static const size_t kUsualAllocationGranularity = 64 * 1024;
 // access for random removal and insertion of elements into the quarantine.
 static const size_t kQuarantineDefaultShardingFactor = 128;
 
+// The maximum number of processors that get their own list in the per-CPU
+// quarantine. Processors beyond this share lists.
+static const size_t kQuarantineMaxProcessorCount = 64;
+
 // @returns the size of a page on the OS (usually 4KB).
 // @note Declaring this as a constant might result in an initialization order
 //     fiasco.
@@ -39,10 +39,8 @@ void CopyStackCaptureToArray(const common::StackCapture* stack_capture,
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
   DCHECK_NE(static_cast<void*>(nullptr), dst);
   DCHECK_NE(static_cast<uint8_t*>(nullptr), dst_size);
-  ::memcpy(dst,
-           stack_capture->frames(),
-           stack_capture->num_frames() * sizeof(void*));
-  *dst_size = static_cast<uint8_t>(stack_capture->num_frames());
+  *dst_size = static_cast<uint8_t>(
+      StackCaptureCache::GetFrames(stack_capture, static_cast<void**>(dst)));
 }
 
 // Get the information about an address relative to a block.
@@ -661,7 +659,7 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
 
   // Any new parameter added to the parameters structure should also be added
   // here.
-  static_assert(15 == ::common::kAsanParametersVersion,
+  static_assert(28 == ::common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   crashdata::Dictionary* param_dict = crashdata::DictAddDict("asan-parameters",
                                                              dict);
@@ -701,6 +699,48 @@ void PopulateAsanParameters(const AsanErrorInfo& error_info,
   crashdata::LeafSetReal(
       error_info.asan_parameters.quarantine_flood_fill_rate,
       crashdata::DictAddLeaf("quarantine-flood-fill-rate", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_thread_local_block_cache,
+      crashdata::DictAddLeaf("enable-thread-local-block-cache", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_per_cpu_quarantine,
+      crashdata::DictAddLeaf("enable-per-cpu-quarantine", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_shadow_decommit,
+      crashdata::DictAddLeaf("enable-shadow-decommit", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_compact_stack_cache,
+      crashdata::DictAddLeaf("enable-compact-stack-cache", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_sampled_allocation_guards,
+      crashdata::DictAddLeaf("enable-sampled-allocation-guards", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.deferred_free_thread_count,
+      crashdata::DictAddLeaf("deferred-free-thread-count", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.zebra_block_heap_region_count,
+      crashdata::DictAddLeaf("zebra-block-heap-region-count", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_buffered_logging,
+      crashdata::DictAddLeaf("enable-buffered-logging", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.heap_checker_thread_count,
+      crashdata::DictAddLeaf("heap-checker-thread-count", param_dict));
+  crashdata::LeafSetReal(
+      error_info.asan_parameters.full_stack_capture_rate,
+      crashdata::DictAddLeaf("full-stack-capture-rate", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.full_stack_captures_per_site,
+      crashdata::DictAddLeaf("full-stack-captures-per-site", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_slab_block_heap,
+      crashdata::DictAddLeaf("enable-slab-block-heap", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_size_class_quarantine,
+      crashdata::DictAddLeaf("enable-size-class-quarantine", param_dict));
+  crashdata::LeafSetUInt(
+      error_info.asan_parameters.enable_large_page_shadow,
+      crashdata::DictAddLeaf("enable-large-page-shadow", param_dict));
 }
 
 }  // namespace
@@ -749,7 +749,21 @@ TEST_F(AsanErrorInfoTest, PopulateErrorInfo) {
       "    \"zebra-block-heap-size\": 16777216,\n"
       "    \"zebra-block-heap-quarantine-ratio\": 2.5000000000000000E-01,\n"
       "    \"large-allocation-threshold\": 20480,\n"
-      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01\n"
+      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01,\n"
+      "    \"enable-thread-local-block-cache\": 0,\n"
+      "    \"enable-per-cpu-quarantine\": 0,\n"
+      "    \"enable-shadow-decommit\": 0,\n"
+      "    \"enable-compact-stack-cache\": 0,\n"
+      "    \"enable-sampled-allocation-guards\": 0,\n"
+      "    \"deferred-free-thread-count\": 1,\n"
+      "    \"zebra-block-heap-region-count\": 4,\n"
+      "    \"enable-buffered-logging\": 0,\n"
+      "    \"heap-checker-thread-count\": 0,\n"
+      "    \"full-stack-capture-rate\": 1.0000000000000000E+00,\n"
+      "    \"full-stack-captures-per-site\": 16,\n"
+      "    \"enable-slab-block-heap\": 0,\n"
+      "    \"enable-size-class-quarantine\": 0,\n"
+      "    \"enable-large-page-shadow\": 0\n"
       "  }\n"
       "}";
   AsanErrorShadowMemory shadow_memory = {};
@@ -898,7 +912,21 @@ TEST_F(AsanErrorInfoTest, PopulateErrorInfoWithMemoryRanges) {
       "    \"zebra-block-heap-size\": 16777216,\n"
       "    \"zebra-block-heap-quarantine-ratio\": 2.5000000000000000E-01,\n"
       "    \"large-allocation-threshold\": 20480,\n"
-      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01\n"
+      "    \"quarantine-flood-fill-rate\": 5.0000000000000000E-01,\n"
+      "    \"enable-thread-local-block-cache\": 0,\n"
+      "    \"enable-per-cpu-quarantine\": 0,\n"
+      "    \"enable-shadow-decommit\": 0,\n"
+      "    \"enable-compact-stack-cache\": 0,\n"
+      "    \"enable-sampled-allocation-guards\": 0,\n"
+      "    \"deferred-free-thread-count\": 1,\n"
+      "    \"zebra-block-heap-region-count\": 4,\n"
+      "    \"enable-buffered-logging\": 0,\n"
+      "    \"heap-checker-thread-count\": 0,\n"
+      "    \"full-stack-capture-rate\": 1.0000000000000000E+00,\n"
+      "    \"full-stack-captures-per-site\": 16,\n"
+      "    \"enable-slab-block-heap\": 0,\n"
+      "    \"enable-size-class-quarantine\": 0,\n"
+      "    \"enable-large-page-shadow\": 0\n"
       "  }\n"
       "}";
   AsanErrorShadowMemory shadow_memory = {};
@@ -29,6 +29,9 @@ EXTERN C asan_memory_interceptors_shadow_memory:FAR
 ; Declare the string checking helper function.
 EXTERN C asan_check_strings_memory_accesses:PROC
 
+; Declare the range checking helper function.
+EXTERN C asan_check_range_memory_access:PROC
+
 ; Declare the redirect function.
 EXTERN C asan_redirect_stub_entry:PROC
 EXTERN C asan_redirect_clang_stub_entry:PROC
@@ -39,6 +42,7 @@ EXTERN C asan_report_bad_memory_access:PROC
 ; Declares the symbols that this compiland exports.
 PUBLIC asan_no_check
 PUBLIC asan_string_no_check
+PUBLIC asan_range_no_check
 PUBLIC asan_redirect_tail
 PUBLIC asan_redirect_tail_clang
 PUBLIC asan_shadow_references
@@ -122,6 +126,8 @@ PUBLIC asan_check_repz_1_byte_stos_access  ; Probe #76.
 PUBLIC asan_check_4_byte_stos_access  ; Probe #77.
 PUBLIC asan_check_2_byte_stos_access  ; Probe #78.
 PUBLIC asan_check_1_byte_stos_access  ; Probe #79.
+PUBLIC asan_check_range_read_access  ; Probe #80.
+PUBLIC asan_check_range_write_access  ; Probe #81.
 
 ; Create a new text segment to house the memory interceptors.
 .probes SEGMENT PAGE PUBLIC READ EXECUTE 'CODE'
@@ -145,6 +151,16 @@ asan_string_no_check PROC
   ret
 asan_string_no_check ENDP
 
+; On entry, the address of the range to check is in EDX, the length of the
+; range is on top of the stack and the previous contents of EDX are below it.
+ALIGN 16
+asan_range_no_check PROC
+  ; Restore EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ; And return.
+  ret 8
+asan_range_no_check ENDP
+
 ; On entry, the address to check is in EDX and the stack has:
 ; - previous contents of EDX.
 ; - return address to original caller.
@@ -5102,6 +5118,76 @@ skip_neg_direction_79 LABEL NEAR
   ret
 asan_check_1_byte_stos_access ENDP
 
+; On entry, the address of the range to check is in EDX, the length of the
+; range is on top of the stack and the previous contents of EDX are below it.
+; On exit the previous contents of EDX have been restored, and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_read_access PROC  ; Probe #80.
+  ; Prologue, save context.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / length / original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Put the original value of EDX in the Asan registers context.
+  mov eax, DWORD PTR[esp + 44]
+  mov DWORD PTR[esp + 20], eax
+  ; By standard calling convention, direction flag must be forward.
+  cld
+  ; Push ARG(context), the Asan registers context.
+  push esp
+  ; Push ARG(access_mode), the access type.
+  push 0
+  ; Push ARG(length), the length of the range.
+  push DWORD PTR[esp + 48]
+  ; Push ARG(location), the start of the range.
+  push edx
+  ; Call the generic check range function.
+  call asan_check_range_memory_access
+  add esp, 16
+  ; Epilogue, restore context. This also restores the original EDX.
+  popad
+  popfd
+  ret 8
+asan_check_range_read_access ENDP
+
+; On entry, the address of the range to check is in EDX, the length of the
+; range is on top of the stack and the previous contents of EDX are below it.
+; On exit the previous contents of EDX have been restored, and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_write_access PROC  ; Probe #81.
+  ; Prologue, save context.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / length / original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Put the original value of EDX in the Asan registers context.
+  mov eax, DWORD PTR[esp + 44]
+  mov DWORD PTR[esp + 20], eax
+  ; By standard calling convention, direction flag must be forward.
+  cld
+  ; Push ARG(context), the Asan registers context.
+  push esp
+  ; Push ARG(access_mode), the access type.
+  push 1
+  ; Push ARG(length), the length of the range.
+  push DWORD PTR[esp + 48]
+  ; Push ARG(location), the start of the range.
+  push edx
+  ; Call the generic check range function.
+  call asan_check_range_memory_access
+  add esp, 16
+  ; Epilogue, restore context. This also restores the original EDX.
+  popad
+  popfd
+  ret 8
+asan_check_range_write_access ENDP
+
 .probes ENDS
 
 ; Start writing to the read-only .rdata segment.
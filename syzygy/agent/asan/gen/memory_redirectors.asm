@@ -79,6 +79,8 @@ PUBLIC asan_redirect_repz_1_byte_stos_access
 PUBLIC asan_redirect_4_byte_stos_access
 PUBLIC asan_redirect_2_byte_stos_access
 PUBLIC asan_redirect_1_byte_stos_access
+PUBLIC asan_redirect_range_read_access
+PUBLIC asan_redirect_range_write_access
 PUBLIC asan_redirect_load1
 PUBLIC asan_redirect_store1
 PUBLIC asan_redirect_load2
@@ -209,6 +211,10 @@ asan_redirect_2_byte_stos_access LABEL PROC
   call asan_redirect_tail
 asan_redirect_1_byte_stos_access LABEL PROC
   call asan_redirect_tail
+asan_redirect_range_read_access LABEL PROC
+  call asan_redirect_tail
+asan_redirect_range_write_access LABEL PROC
+  call asan_redirect_tail
 asan_redirect_load1 LABEL PROC
   call asan_redirect_tail_clang
 asan_redirect_store1 LABEL PROC
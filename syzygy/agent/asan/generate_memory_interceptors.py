@@ -99,6 +99,9 @@ EXTERN C {shadow}:FAR
 ; Declare the string checking helper function.
 EXTERN C asan_check_strings_memory_accesses:PROC
 
+; Declare the range checking helper function.
+EXTERN C asan_check_range_memory_access:PROC
+
 ; Declare the redirect function.
 EXTERN C asan_redirect_stub_entry:PROC
 EXTERN C asan_redirect_clang_stub_entry:PROC
@@ -109,6 +112,7 @@ EXTERN C asan_report_bad_memory_access:PROC
 ; Declares the symbols that this compiland exports.
 PUBLIC asan_no_check
 PUBLIC asan_string_no_check
+PUBLIC asan_range_no_check
 PUBLIC asan_redirect_tail
 PUBLIC asan_redirect_tail_clang
 PUBLIC asan_shadow_references"""
@@ -171,6 +175,16 @@ asan_string_no_check PROC
   ret
 asan_string_no_check ENDP
 
+; On entry, the address of the range to check is in EDX, the length of the
+; range is on top of the stack and the previous contents of EDX are below it.
+ALIGN 16
+asan_range_no_check PROC
+  ; Restore EDX.
+  mov edx, DWORD PTR[esp + 8]
+  ; And return.
+  ret 8
+asan_range_no_check ENDP
+
 ; On entry, the address to check is in EDX and the stack has:
 ; - previous contents of EDX.
 ; - return address to original caller.
@@ -595,6 +609,77 @@ _STRING_REDIRECT_FUNCTION_DECL = """\
 PUBLIC asan_redirect{prefix}{access_size}_byte_{func}_access"""
 
 
+# Generates the Asan check access functions for a range of memory.
+#
+# The name of the generated method will be
+# asan_check_range_(@p access_mode_str)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+#   access_mode_value: The internal value representing this kind of access.
+#   probe_index: The index of the probe function. Used to mangle internal labels
+#       so that they are unique to this probes implementation.
+_CHECK_RANGE = """\
+; On entry, the address of the range to check is in EDX, the length of the
+; range is on top of the stack and the previous contents of EDX are below it.
+; On exit the previous contents of EDX have been restored, and both values
+; popped off the stack. This function modifies no other registers, in
+; particular it saves and restores EFLAGS.
+ALIGN 16
+asan_check_range_{access_mode_str} PROC  ; Probe #{probe_index}.
+  ; Prologue, save context.
+  pushfd
+  pushad
+  ; Fix the original value of ESP in the Asan registers context.
+  ; Removing 16 bytes (e.g. EFLAGS / EIP / length / original EDX).
+  add DWORD PTR[esp + 12], 16
+  ; Put the original value of EDX in the Asan registers context.
+  mov eax, DWORD PTR[esp + 44]
+  mov DWORD PTR[esp + 20], eax
+  ; By standard calling convention, direction flag must be forward.
+  cld
+  ; Push ARG(context), the Asan registers context.
+  push esp
+  ; Push ARG(access_mode), the access type.
+  push {access_mode_value}
+  ; Push ARG(length), the length of the range.
+  push DWORD PTR[esp + 48]
+  ; Push ARG(location), the start of the range.
+  push edx
+  ; Call the generic check range function.
+  call asan_check_range_memory_access
+  add esp, 16
+  ; Epilogue, restore context. This also restores the original EDX.
+  popad
+  popfd
+  ret 8
+asan_check_range_{access_mode_str} ENDP
+"""
+
+
+# Declare the range checking probe public label.
+_CHECK_RANGE_DECL = """\
+PUBLIC asan_check_range_{access_mode_str}  ; Probe #{probe_index}."""
+
+
+# Generates the Asan range memory accessor redirector stubs.
+#
+# The name of the generated method will be
+# asan_redirect_range_(@p access_mode_str)().
+#
+# Args:
+#   access_mode_str: The string representing the access mode (read_access
+#       or write_access).
+_RANGE_REDIRECT_FUNCTION = """\
+asan_redirect_range_{access_mode_str} LABEL PROC
+  call asan_redirect_tail"""
+
+# Declare the public label.
+_RANGE_REDIRECT_FUNCTION_DECL = """\
+PUBLIC asan_redirect_range_{access_mode_str}"""
+
+
 class MacroAssembler(string.Formatter):
   """A formatter specialization to inject the AsanXXX macros and make
   them easier to use."""
@@ -763,6 +848,18 @@ def _IterateOverStringInterceptors(parts, formatter, format, probe_index=0):
   return probe_index
 
 
+def _IterateOverRangeInterceptors(parts, formatter, format, probe_index=0):
+  """Helper for _GenerateInterceptorsAsmFile."""
+  for access, access_name in _ACCESS_MODES:
+    parts.append(formatter.format(format,
+                                  access_mode_str=access,
+                                  access_mode_value=access_name,
+                                  probe_index=probe_index))
+    probe_index += 1
+
+  return probe_index
+
+
 def _GenerateInterceptorsAsmFile():
   f = MacroAssembler()
   parts = [f.format(_ASM_HEADER,
@@ -781,6 +878,8 @@ def _GenerateInterceptorsAsmFile():
       probe_index=probe_index, shadow_index=shadow_index)
   probe_index = _IterateOverStringInterceptors(parts, f, _CHECK_STRINGS_DECL,
       probe_index=probe_index)
+  probe_index = _IterateOverRangeInterceptors(parts, f, _CHECK_RANGE_DECL,
+      probe_index=probe_index)
   parts.append('')
 
   # Place all of the probe functions in a custom segment.
@@ -810,6 +909,10 @@ def _GenerateInterceptorsAsmFile():
   probe_index = _IterateOverStringInterceptors(parts, f, _CHECK_STRINGS,
       probe_index=probe_index)
 
+  # Generate range accessors.
+  probe_index = _IterateOverRangeInterceptors(parts, f, _CHECK_RANGE,
+      probe_index=probe_index)
+
   # Close the custom segment housing the probges.
   parts.append(f.format(_INTERCEPTORS_SEGMENT_FOOTER))
 
@@ -863,6 +966,11 @@ def _GenerateRedirectorsAsmFile(target_cpu):
                             access_size=size,
                             compare=compare))
 
+    # Declare range redirectors.
+    for access, access_name in _ACCESS_MODES:
+      parts.append(f.format(_RANGE_REDIRECT_FUNCTION_DECL,
+                            access_mode_str=access))
+
   # Generate the Clang-Asan probes
   for access_size in _ACCESS_SIZES:
     for access, access_name in _CLANG_ACCESS_MODES:
@@ -894,6 +1002,11 @@ def _GenerateRedirectorsAsmFile(target_cpu):
                             access_size=size,
                             compare=compare))
 
+    # Generate range redirectors.
+    for access, access_name in _ACCESS_MODES:
+      parts.append(f.format(_RANGE_REDIRECT_FUNCTION,
+                            access_mode_str=access))
+
   # Generate the Clang-Asan accessor redirectors
   for access_size in _ACCESS_SIZES:
     for access, access_name in _CLANG_ACCESS_MODES:
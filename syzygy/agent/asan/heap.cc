@@ -22,7 +22,8 @@ const char* kHeapTypes[kHeapTypeMax] = {
     "WinHeap",
     "DISABLED_CtMalloc",
     "LargeBlockHeap",
-    "ZebraBlockHeap" };
+    "ZebraBlockHeap",
+    "SlabBlockHeap" };
 
 }  // namespace asan
 }  // namespace agent
@@ -25,6 +25,7 @@
 #define SYZYGY_AGENT_ASAN_HEAP_H_
 
 #include "syzygy/agent/asan/block.h"
+#include "syzygy/common/recursive_lock.h"
 
 namespace agent {
 namespace asan {
@@ -38,6 +39,7 @@ enum HeapType {
   kReserved, // Was kCtMalloc.
   kLargeBlockHeap,
   kZebraBlockHeap,
+  kSlabBlockHeap,
 
   // This must be last.
   kHeapTypeMax,
@@ -133,6 +135,15 @@ class HeapInterface {
   // Tries to lock this heap.
   // @returns true if the lock was acquired, false otherwise.
   virtual bool TryLock() = 0;
+
+  // Gets the contention statistics of the lock protecting this heap. Heaps
+  // that don't keep any simply don't override this.
+  // @param statistics Will receive the statistics.
+  // @returns true on success, false if this heap doesn't keep statistics.
+  virtual bool GetLockStatistics(
+      ::common::RecursiveLock::Statistics* statistics) {
+    return false;
+  }
 };
 
 // Declares the interface that a block-allocating heap must implement. The API
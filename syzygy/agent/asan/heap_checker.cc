@@ -14,15 +14,281 @@
 
 #include "syzygy/agent/asan/heap_checker.h"
 
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/platform_thread.h"
+#include "syzygy/agent/asan/block_utils.h"
 #include "syzygy/agent/asan/page_protection_helpers.h"
 #include "syzygy/agent/asan/runtime.h"
 #include "syzygy/agent/asan/shadow.h"
+#include "syzygy/common/align.h"
 
 namespace agent {
 namespace asan {
 
+namespace {
+
+// The number of partitions per heap walking thread. The heap is rarely spread
+// evenly over the address space, so having more partitions than threads
+// balances the load. This also bounds how much of the heap is lost when the
+// time budget runs out.
+const size_t kPartitionsPerThread = 8;
+
+// The alignment of the partition boundaries.
+const size_t kPartitionAlignment = 64 * 1024;
+
+// The number of blocks walked between two checks of the deadline.
+const size_t kBlocksPerDeadlineCheck = 1024;
+
+// Adds a block to the corrupt ranges being built for a walk. This extends the
+// current corrupt range, starts a new one, or ends the current one.
+// @param block_info The block to add.
+// @param block_is_corrupt Indicates if the block is corrupt.
+// @param current_corrupt_range The corrupt range containing the previous
+//     block, or nullptr if it wasn't corrupt.
+// @param corrupt_ranges The corrupt ranges being built.
+void AddBlockToCorruptRanges(const BlockInfo& block_info,
+                             bool block_is_corrupt,
+                             AsanCorruptBlockRange** current_corrupt_range,
+                             HeapChecker::CorruptRangesVector* corrupt_ranges) {
+  // If the current block is corrupt and |current_corrupt_range| is nullptr
+  // then this means that the current block is at the beginning of a corrupt
+  // range.
+  if (block_is_corrupt && *current_corrupt_range == nullptr) {
+    AsanCorruptBlockRange corrupt_range;
+    corrupt_range.address = block_info.header;
+    corrupt_range.length = 0;
+    corrupt_range.block_count = 0;
+    corrupt_range.block_info = nullptr;
+    corrupt_range.block_info_count = 0;
+    corrupt_ranges->push_back(corrupt_range);
+    *current_corrupt_range = &corrupt_ranges->back();
+  } else if (!block_is_corrupt && *current_corrupt_range != nullptr) {
+    *current_corrupt_range = nullptr;
+  }
+
+  if (block_is_corrupt) {
+    // If the current block is corrupt then we need to update the size of the
+    // current range.
+    DCHECK_NE(static_cast<AsanCorruptBlockRange*>(nullptr),
+              *current_corrupt_range);
+    (*current_corrupt_range)->block_count++;
+    const uint8_t* current_block_end =
+        block_info.RawHeader() + block_info.block_size;
+    (*current_corrupt_range)->length =
+        current_block_end -
+        reinterpret_cast<const uint8_t*>((*current_corrupt_range)->address);
+  }
+}
+
+// @returns true if some of the pages of a block are protected.
+bool BlockHasProtectedPages(const Shadow* shadow, const BlockInfo& block_info) {
+  const uint8_t* pages_end =
+      block_info.block_pages + block_info.block_pages_size;
+  for (const uint8_t* page = block_info.block_pages; page < pages_end;
+       page += GetPageSize()) {
+    if (shadow->PageIsProtected(page))
+      return true;
+  }
+  return false;
+}
+
+// A block observed by a heap walking thread. Consecutive clean blocks are
+// collapsed into a single entry.
+struct WalkedBlock {
+  enum State {
+    kCleanBlocks,
+    kCorruptBlock,
+    // The block has protected pages, so it can only be checked once they are
+    // removed. This is left to the thread holding block_protect_lock.
+    kProtectedBlock,
+  };
+
+  State state;
+  // The block, for the corrupt and protected ones.
+  BlockInfo block_info;
+};
+
+// The result of the walk of a partition of the address space.
+struct PartitionResult {
+  PartitionResult() : incomplete(false), done(0) {}
+
+  // The walked blocks, in address order.
+  std::vector<WalkedBlock> blocks;
+  // Indicates if the walk of this partition ran out of time.
+  bool incomplete;
+  // Set once the partition has been walked or skipped. The other fields can
+  // be read only once this is set.
+  base::subtle::Atomic32 done;
+};
+
+// The state shared by the threads walking the heap. This is reference
+// counted, as a thread may only start running after the walk is over.
+class ParallelHeapWalk : public base::RefCountedThreadSafe<ParallelHeapWalk> {
+ public:
+  // Constructor.
+  // @param shadow The shadow memory to walk.
+  // @param lower_bound The lower bound of the walked memory (inclusive).
+  // @param upper_bound The upper bound of the walked memory (exclusive). An
+  //     overflowed value of 0 indicates the end of all memory.
+  // @param partition_count The number of partitions to split the memory in.
+  // @param deadline The time after which the partitions are skipped.
+  ParallelHeapWalk(const Shadow* shadow,
+                   const uint8_t* lower_bound,
+                   const uint8_t* upper_bound,
+                   size_t partition_count,
+                   base::TimeTicks deadline)
+      : shadow_(shadow),
+        lower_bound_(lower_bound),
+        upper_bound_(upper_bound),
+        partition_size_(0),
+        partitions_(partition_count),
+        next_partition_(0),
+        done_partition_count_(0),
+        all_done_event_(true, false),
+        deadline_(deadline) {
+    DCHECK_LT(0u, partition_count);
+    // This relies on unsigned arithmetic to handle an overflowed upper bound.
+    size_t size = reinterpret_cast<uintptr_t>(upper_bound) -
+                  reinterpret_cast<uintptr_t>(lower_bound);
+    partition_size_ = ::common::AlignDown(size / partition_count,
+                                          kPartitionAlignment);
+  }
+
+  // Walks the partitions that haven't been claimed yet, until none are left.
+  void WalkPartitions() {
+    while (true) {
+      size_t index = static_cast<size_t>(
+          base::subtle::NoBarrier_AtomicIncrement(&next_partition_, 1)) - 1;
+      if (index >= partitions_.size())
+        return;
+
+      PartitionResult* result = &partitions_[index];
+      if (base::TimeTicks::Now() >= deadline_) {
+        result->incomplete = true;
+      } else {
+        WalkPartition(index, result);
+      }
+      base::subtle::Release_Store(&result->done, 1);
+
+      if (static_cast<size_t>(base::subtle::Barrier_AtomicIncrement(
+              &done_partition_count_, 1)) == partitions_.size()) {
+        all_done_event_.Signal();
+      }
+    }
+  }
+
+  // Waits for all the partitions to be done, or for the deadline.
+  void WaitForPartitions() {
+    base::TimeDelta remaining = deadline_ - base::TimeTicks::Now();
+    if (remaining > base::TimeDelta())
+      all_done_event_.TimedWait(remaining);
+  }
+
+  // @returns the number of partitions.
+  size_t partition_count() const { return partitions_.size(); }
+
+  // @param index The index of a partition.
+  // @returns the result of the walk of the partition, or nullptr if it's not
+  //     done yet.
+  const PartitionResult* GetPartitionResult(size_t index) const {
+    DCHECK_GT(partitions_.size(), index);
+    if (base::subtle::Acquire_Load(&partitions_[index].done) == 0)
+      return nullptr;
+    return &partitions_[index];
+  }
+
+ private:
+  friend class base::RefCountedThreadSafe<ParallelHeapWalk>;
+  ~ParallelHeapWalk() {}
+
+  // Walks a partition. The blocks are attributed to the partition containing
+  // their header.
+  // @param index The index of the partition.
+  // @param result Will receive the result of the walk.
+  void WalkPartition(size_t index, PartitionResult* result) {
+    const uint8_t* lower_bound = lower_bound_ + index * partition_size_;
+    const uint8_t* upper_bound = upper_bound_;
+    if (index + 1 < partitions_.size())
+      upper_bound = lower_bound + partition_size_;
+
+    ShadowWalker shadow_walker(shadow_, lower_bound, upper_bound);
+    BlockInfo block_info = {};
+    size_t block_count = 0;
+    while (shadow_walker.Next(&block_info)) {
+      if (++block_count % kBlocksPerDeadlineCheck == 0 &&
+          base::TimeTicks::Now() >= deadline_) {
+        result->incomplete = true;
+        return;
+      }
+
+      WalkedBlock walked_block = {};
+      if (BlockHasProtectedPages(shadow_, block_info)) {
+        walked_block.state = WalkedBlock::kProtectedBlock;
+      } else if (IsBlockCorrupt(block_info)) {
+        walked_block.state = WalkedBlock::kCorruptBlock;
+      } else {
+        walked_block.state = WalkedBlock::kCleanBlocks;
+        if (!result->blocks.empty() &&
+            result->blocks.back().state == WalkedBlock::kCleanBlocks) {
+          continue;
+        }
+      }
+      if (walked_block.state != WalkedBlock::kCleanBlocks)
+        walked_block.block_info = block_info;
+      result->blocks.push_back(walked_block);
+    }
+  }
+
+  const Shadow* shadow_;
+  const uint8_t* lower_bound_;
+  const uint8_t* upper_bound_;
+  size_t partition_size_;
+
+  std::vector<PartitionResult> partitions_;
+
+  // The index of the next partition to claim.
+  base::subtle::Atomic32 next_partition_;
+
+  // The number of partitions that are done, and the event signaled once they
+  // all are.
+  base::subtle::Atomic32 done_partition_count_;
+  base::WaitableEvent all_done_event_;
+
+  base::TimeTicks deadline_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelHeapWalk);
+};
+
+// A thread helping with a parallel heap walk. This deletes itself once it's
+// done.
+class HeapWalkerThread : public base::PlatformThread::Delegate {
+ public:
+  explicit HeapWalkerThread(ParallelHeapWalk* walk) : walk_(walk) {
+    DCHECK_NE(static_cast<ParallelHeapWalk*>(nullptr), walk);
+  }
+
+  // @name base::PlatformThread::Delegate implementation.
+  // @{
+  void ThreadMain() override {
+    walk_->WalkPartitions();
+    delete this;
+  }
+  // @}
+
+ private:
+  scoped_refptr<ParallelHeapWalk> walk_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeapWalkerThread);
+};
+
+}  // namespace
+
 HeapChecker::HeapChecker(Shadow* shadow)
-    : shadow_(shadow) {
+    : shadow_(shadow), thread_count_(1), walk_completed_(true) {
   DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
 }
 
@@ -30,6 +296,7 @@ bool HeapChecker::IsHeapCorrupt(CorruptRangesVector* corrupt_ranges) {
   DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
 
   corrupt_ranges->clear();
+  walk_completed_ = true;
 
   // Grab the page protection lock. This prevents multiple heap checkers from
   // running simultaneously, and also prevents page protections from being
@@ -40,14 +307,25 @@ bool HeapChecker::IsHeapCorrupt(CorruptRangesVector* corrupt_ranges) {
   // Allow memory_size to overflow to 0 for 4GB 32-bit processes.
   // TODO(sebmarchand): Iterates over the heap slabs once we have switched to
   //     a new memory allocator.
-  GetCorruptRangesInSlab(
-      reinterpret_cast<const uint8_t*>(Shadow::kAddressLowerBound),
-      reinterpret_cast<const uint8_t*>(shadow_->memory_size()),
-      corrupt_ranges);
+  const uint8_t* lower_bound =
+      reinterpret_cast<const uint8_t*>(Shadow::kAddressLowerBound);
+  const uint8_t* upper_bound =
+      reinterpret_cast<const uint8_t*>(shadow_->memory_size());
+  if (thread_count_ > 1) {
+    GetCorruptRangesInSlabParallel(lower_bound, upper_bound, corrupt_ranges);
+  } else {
+    GetCorruptRangesInSlab(lower_bound, upper_bound, corrupt_ranges);
+  }
 
   return !corrupt_ranges->empty();
 }
 
+void HeapChecker::EnableParallelWalk(size_t thread_count,
+                                     base::TimeDelta time_budget) {
+  thread_count_ = thread_count;
+  time_budget_ = time_budget;
+}
+
 void HeapChecker::GetCorruptRangesInSlab(const uint8_t* lower_bound,
                                          const uint8_t* upper_bound,
                                          CorruptRangesVector* corrupt_ranges) {
@@ -68,34 +346,71 @@ void HeapChecker::GetCorruptRangesInSlab(const uint8_t* lower_bound,
     // minidump generation has free access to block contents.
     BlockProtectNone(block_info, shadow_);
 
-    bool current_block_is_corrupt = IsBlockCorrupt(block_info);
-    // If the current block is corrupt and |current_corrupt_range| is nullptr
-    // then this means that the current block is at the beginning of a corrupt
-    // range.
-    if (current_block_is_corrupt && current_corrupt_range == nullptr) {
-      AsanCorruptBlockRange corrupt_range;
-      corrupt_range.address = block_info.header;
-      corrupt_range.length = 0;
-      corrupt_range.block_count = 0;
-      corrupt_range.block_info = nullptr;
-      corrupt_range.block_info_count = 0;
-      corrupt_ranges->push_back(corrupt_range);
-      current_corrupt_range = &corrupt_ranges->back();
-    } else if (!current_block_is_corrupt && current_corrupt_range != nullptr) {
+    AddBlockToCorruptRanges(block_info, IsBlockCorrupt(block_info),
+                            &current_corrupt_range, corrupt_ranges);
+  }
+}
+
+void HeapChecker::GetCorruptRangesInSlabParallel(
+    const uint8_t* lower_bound,
+    const uint8_t* upper_bound,
+    CorruptRangesVector* corrupt_ranges) {
+  DCHECK_NE(static_cast<const uint8_t*>(nullptr), lower_bound);
+  DCHECK(upper_bound == nullptr || lower_bound <= upper_bound);
+  DCHECK_NE(static_cast<CorruptRangesVector*>(nullptr), corrupt_ranges);
+  DCHECK_LT(1u, thread_count_);
+  block_protect_lock.AssertAcquired();
+
+  scoped_refptr<ParallelHeapWalk> walk(new ParallelHeapWalk(
+      shadow_, lower_bound, upper_bound, thread_count_ * kPartitionsPerThread,
+      base::TimeTicks::Now() + time_budget_));
+
+  // The threads that fail to start are simply not helping.
+  for (size_t i = 1; i < thread_count_; ++i) {
+    HeapWalkerThread* thread = new HeapWalkerThread(walk.get());
+    if (!base::PlatformThread::CreateNonJoinable(0, thread))
+      delete thread;
+  }
+
+  walk->WalkPartitions();
+  walk->WaitForPartitions();
+
+  // Merge the results of the partitions in address order. The blocks with
+  // protected pages are checked here, as this thread owns the page
+  // protections. They are left unprotected, as in the serial walk.
+  AsanCorruptBlockRange* current_corrupt_range = nullptr;
+  for (size_t i = 0; i < walk->partition_count(); ++i) {
+    const PartitionResult* result = walk->GetPartitionResult(i);
+    if (result == nullptr) {
+      walk_completed_ = false;
       current_corrupt_range = nullptr;
+      continue;
+    }
+
+    for (const WalkedBlock& walked_block : result->blocks) {
+      switch (walked_block.state) {
+        case WalkedBlock::kCleanBlocks:
+          current_corrupt_range = nullptr;
+          break;
+
+        case WalkedBlock::kCorruptBlock:
+          AddBlockToCorruptRanges(walked_block.block_info, true,
+                                  &current_corrupt_range, corrupt_ranges);
+          break;
+
+        case WalkedBlock::kProtectedBlock:
+          BlockProtectNone(walked_block.block_info, shadow_);
+          AddBlockToCorruptRanges(walked_block.block_info,
+                                  IsBlockCorrupt(walked_block.block_info),
+                                  &current_corrupt_range, corrupt_ranges);
+          break;
+      }
     }
 
-    if (current_block_is_corrupt) {
-      // If the current block is corrupt then we need to update the size of the
-      // current range.
-      DCHECK_NE(reinterpret_cast<AsanCorruptBlockRange*>(nullptr),
-                current_corrupt_range);
-      current_corrupt_range->block_count++;
-      const uint8_t* current_block_end =
-          block_info.RawHeader() + block_info.block_size;
-      current_corrupt_range->length =
-          current_block_end -
-          reinterpret_cast<const uint8_t*>(current_corrupt_range->address);
+    // Ranges can't span the parts of the heap that weren't walked.
+    if (result->incomplete) {
+      walk_completed_ = false;
+      current_corrupt_range = nullptr;
     }
   }
 }
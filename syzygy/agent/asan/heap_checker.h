@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "base/logging.h"
+#include "base/time/time.h"
 #include "syzygy/agent/asan/error_info.h"
 #include "syzygy/agent/common/stack_capture.h"
 
@@ -47,6 +48,21 @@ class HeapChecker {
   // @returns true if the heap is corrupt, false otherwise.
   bool IsHeapCorrupt(CorruptRangesVector* corrupt_ranges);
 
+  // Enables walking the heap on several threads. The address space is split
+  // into partitions that are claimed by the walking threads as they go. The
+  // calling thread walks partitions as well, so that the check still
+  // completes if the other threads can't start, e.g. under the loader lock.
+  // @param thread_count The number of threads walking the heap, including
+  //     the calling thread. Values of 0 and 1 restore the serial walk.
+  // @param time_budget The time after which the partitions that haven't been
+  //     walked yet are skipped. The corrupt ranges found until then are still
+  //     reported.
+  void EnableParallelWalk(size_t thread_count, base::TimeDelta time_budget);
+
+  // @returns false if the last call to IsHeapCorrupt checked only a part of
+  //     the heap, as it ran out of its time budget.
+  bool walk_completed() const { return walk_completed_; }
+
   // TODO(sebmarchand): Add a testing seam that controls the range of memory
   //     that is walked by HeapChecker to keep unittest times to something
   //     reasonable.
@@ -62,9 +78,29 @@ class HeapChecker {
                               const uint8_t* upper_bound,
                               CorruptRangesVector* corrupt_ranges);
 
+  // Get the information about the corrupt ranges in a heap slab, by walking
+  // partitions of it on several threads.
+  // @param lower_bound The lower bound for this slab (inclusive).
+  // @param upper_bound The upper bound for this slab (exclusive). An
+  //     overflowed value of 0 indicates the end of all memory.
+  // @param corrupt_ranges Will receive the information about the corrupt ranges
+  //     in this slab.
+  // @note Under block_protect_lock.
+  void GetCorruptRangesInSlabParallel(const uint8_t* lower_bound,
+                                      const uint8_t* upper_bound,
+                                      CorruptRangesVector* corrupt_ranges);
+
   // The shadow memory that will be analyzed.
   Shadow* shadow_;
 
+  // The number of threads walking the heap, and the time they're given to do
+  // so. A thread count smaller than 2 means a serial walk without deadline.
+  size_t thread_count_;
+  base::TimeDelta time_budget_;
+
+  // Indicates if the last walk covered the whole heap.
+  bool walk_completed_;
+
   DISALLOW_COPY_AND_ASSIGN(HeapChecker);
 };
 
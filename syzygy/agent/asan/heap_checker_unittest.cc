@@ -204,5 +204,91 @@ TEST_F(HeapCheckerTest, IsHeapCorrupt) {
   ::free(global_alloc);
 }
 
+TEST_F(HeapCheckerTest, ParallelWalkHandlesPageProtections) {
+  FakeAsanBlock fake_large_block(
+      runtime_->shadow(), kShadowRatioLog, runtime_->stack_cache());
+  fake_large_block.InitializeBlock(2 * static_cast<uint32_t>(GetPageSize()));
+  base::RandBytes(fake_large_block.block_info.body, 2 * GetPageSize());
+  fake_large_block.MarkBlockAsQuarantined();
+  BlockProtectAll(fake_large_block.block_info, runtime_->shadow());
+
+  HeapChecker heap_checker(runtime_->shadow());
+  heap_checker.EnableParallelWalk(4, base::TimeDelta::Max());
+  HeapChecker::CorruptRangesVector corrupt_ranges;
+  EXPECT_FALSE(heap_checker.IsHeapCorrupt(&corrupt_ranges));
+  EXPECT_TRUE(heap_checker.walk_completed());
+
+  // The protections are removed, as in the serial walk.
+  EXPECT_FALSE(runtime_->shadow()->PageIsProtected(
+      fake_large_block.block_info.block_pages));
+
+  BlockProtectNone(fake_large_block.block_info, runtime_->shadow());
+}
+
+TEST_F(HeapCheckerTest, ParallelWalkIsHeapCorrupt) {
+  const size_t kAllocSize = 100;
+
+  BlockLayout block_layout = {};
+  EXPECT_TRUE(BlockPlanLayout(kShadowRatio, kShadowRatio, kAllocSize, 0, 0,
+                              &block_layout));
+
+  const size_t kNumberOfBlocks = 4;
+  size_t total_alloc_size = block_layout.block_size * kNumberOfBlocks;
+  uint8_t* global_alloc =
+      reinterpret_cast<uint8_t*>(::malloc(total_alloc_size));
+
+  BlockHeader* block_headers[kNumberOfBlocks];
+  for (size_t i = 0; i < kNumberOfBlocks; ++i) {
+    BlockInfo block_info = {};
+    BlockInitialize(block_layout, global_alloc + i * block_layout.block_size,
+                    &block_info);
+    runtime_->shadow()->PoisonAllocatedBlock(block_info);
+    BlockSetChecksum(block_info);
+    block_headers[i] = block_info.header;
+  }
+
+  HeapChecker heap_checker(runtime_->shadow());
+  heap_checker.EnableParallelWalk(4, base::TimeDelta::Max());
+  HeapChecker::CorruptRangesVector corrupt_ranges;
+  EXPECT_FALSE(heap_checker.IsHeapCorrupt(&corrupt_ranges));
+
+  // Corrupt the header of the first two blocks and of the last one.
+  block_headers[0]->magic++;
+  block_headers[1]->magic++;
+  block_headers[kNumberOfBlocks - 1]->magic++;
+
+  // The ranges must be the same as the ones of the serial walk.
+  EXPECT_TRUE(heap_checker.IsHeapCorrupt(&corrupt_ranges));
+  EXPECT_TRUE(heap_checker.walk_completed());
+  HeapChecker serial_heap_checker(runtime_->shadow());
+  HeapChecker::CorruptRangesVector serial_corrupt_ranges;
+  EXPECT_TRUE(serial_heap_checker.IsHeapCorrupt(&serial_corrupt_ranges));
+
+  ASSERT_EQ(2, corrupt_ranges.size());
+  ASSERT_EQ(serial_corrupt_ranges.size(), corrupt_ranges.size());
+  for (size_t i = 0; i < corrupt_ranges.size(); ++i) {
+    EXPECT_EQ(serial_corrupt_ranges[i].address, corrupt_ranges[i].address);
+    EXPECT_EQ(serial_corrupt_ranges[i].length, corrupt_ranges[i].length);
+    EXPECT_EQ(serial_corrupt_ranges[i].block_count,
+              corrupt_ranges[i].block_count);
+  }
+  EXPECT_EQ(block_headers[0], corrupt_ranges[0].address);
+  EXPECT_EQ(2, corrupt_ranges[0].block_count);
+  EXPECT_EQ(block_headers[kNumberOfBlocks - 1], corrupt_ranges[1].address);
+  EXPECT_EQ(1, corrupt_ranges[1].block_count);
+
+  // Without any time to walk the heap, nothing gets checked.
+  heap_checker.EnableParallelWalk(4, base::TimeDelta());
+  EXPECT_FALSE(heap_checker.IsHeapCorrupt(&corrupt_ranges));
+  EXPECT_FALSE(heap_checker.walk_completed());
+
+  block_headers[0]->magic--;
+  block_headers[1]->magic--;
+  block_headers[kNumberOfBlocks - 1]->magic--;
+
+  runtime_->shadow()->Unpoison(global_alloc, total_alloc_size);
+  ::free(global_alloc);
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -15,6 +15,7 @@
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
 
 #include <algorithm>
+#include <cmath>
 #include <utility>
 
 #include "base/bind.h"
@@ -26,8 +27,10 @@
 #include "syzygy/agent/asan/heaps/internal_heap.h"
 #include "syzygy/agent/asan/heaps/large_block_heap.h"
 #include "syzygy/agent/asan/heaps/simple_block_heap.h"
+#include "syzygy/agent/asan/heaps/slab_block_heap.h"
 #include "syzygy/agent/asan/heaps/win_heap.h"
 #include "syzygy/agent/asan/heaps/zebra_block_heap.h"
+#include "syzygy/agent/common/stack_walker.h"
 #include "syzygy/common/asan_parameters.h"
 
 namespace agent {
@@ -38,6 +41,7 @@ namespace {
 
 typedef HeapManagerInterface::HeapId HeapId;
 using heaps::LargeBlockHeap;
+using heaps::SlabBlockHeap;
 using heaps::ZebraBlockHeap;
 
 // For now, the overbudget size is always set to 20% of the size of the
@@ -66,6 +70,54 @@ size_t GetMSBIndex(size_t n) {
   return r;
 }
 
+// Returns the size class of an allocation, as described by
+// AsanRuntimeStatistics.
+size_t GetAllocationSizeClass(uint32_t bytes) {
+  if (bytes == 0)
+    return 0;
+  return std::min(GetMSBIndex(bytes) + 1,
+                  AsanRuntimeStatistics::kSizeClassCount - 1);
+}
+
+// Returns the depth at which the stacks that will be saved to a stack cache
+// should be captured. There's no point in walking more frames than the cache
+// is configured to hold.
+size_t GetStackCaptureDepth(const StackCaptureCache* stack_cache) {
+  DCHECK_NE(static_cast<const StackCaptureCache*>(nullptr), stack_cache);
+  size_t depth = std::min(stack_cache->max_num_frames(),
+                          common::StackCapture::kMaxNumFrames);
+  return std::max<size_t>(depth, 1);
+}
+
+// The number of innermost frames making up the fingerprint of a call site,
+// which is saved in place of the full stack when the full stack isn't
+// sampled. This is enough to identify the function allocating or freeing
+// memory past the runtime's own frames.
+const size_t kStackFingerprintDepth = 4;
+
+// Captures the fingerprint of the current call site. Unlike
+// StackCapture::InitFromStack this doesn't walk to the bottom of the stack,
+// so the cost doesn't depend on its depth.
+// @param fingerprint The stack capture to initialize.
+// @returns true on success, false otherwise.
+bool CaptureStackFingerprint(common::StackCapture* fingerprint) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), fingerprint);
+  void* frames[kStackFingerprintDepth] = {};
+  common::StackCapture::StackId stack_id = 0;
+  size_t num_frames = agent::common::WalkStack(
+      0, kStackFingerprintDepth, frames, &stack_id);
+  if (num_frames == 0)
+    return false;
+  fingerprint->InitFromBuffer(frames, num_frames);
+  return true;
+}
+
+// Increments a statistics counter.
+void IncrementCounter(base::subtle::Atomic32* counter, size_t value) {
+  base::subtle::NoBarrier_AtomicIncrement(
+      counter, static_cast<base::subtle::Atomic32>(value));
+}
+
 // Try to do an unguarded allocation.
 // @param heap_interface The heap that should serve the allocation.
 // @param shadow The shadow memory.
@@ -82,6 +134,38 @@ void* DoUnguardedAllocation(BlockHeapInterface* heap_interface,
   return alloc;
 }
 
+// Draws the number of allocations up to and including the next guarded one,
+// when they are guarded independently with a given probability. This follows
+// a geometric distribution.
+// @param rate The probability with which allocations are guarded. Must be in
+//     (0, 1).
+// @returns the number of allocations until the next guarded one.
+size_t GetSamplingInterval(float rate) {
+  DCHECK_LT(0.0f, rate);
+  DCHECK_GT(1.0f, rate);
+  static const double kMaxInterval = 1 << 30;
+  double interval =
+      std::floor(std::log(1.0 - base::RandDouble()) / std::log(1.0 - rate));
+  return static_cast<size_t>(std::min(interval, kMaxInterval)) + 1;
+}
+
+// Removes the page protections of a group of blocks at once. Blocks that are
+// contiguous in memory, as is typical of the zebra heap, share a single
+// system call.
+// @param blocks The blocks to unprotect.
+// @param count The number of blocks.
+// @param shadow The shadow to update.
+void UnprotectBlocks(const CompactBlockInfo* blocks,
+                     size_t count,
+                     Shadow* shadow) {
+  PageProtectionBatch batch(shadow);
+  for (size_t i = 0; i < count; ++i) {
+    BlockInfo expanded = {};
+    ConvertBlockInfo(blocks[i], &expanded);
+    BlockProtectNone(expanded, &batch);
+  }
+}
+
 }  // namespace
 
 BlockHeapManager::BlockHeapManager(Shadow* shadow,
@@ -91,24 +175,38 @@ BlockHeapManager::BlockHeapManager(Shadow* shadow,
       stack_cache_(stack_cache),
       memory_notifier_(memory_notifier),
       initialized_(false),
+      shared_quarantine_(&sharded_quarantine_),
       process_heap_(nullptr),
       process_heap_underlying_heap_(nullptr),
       process_heap_id_(0),
       zebra_block_heap_(nullptr),
       zebra_block_heap_id_(0),
       large_block_heap_id_(0),
+      slab_block_heap_id_(0),
       locked_heaps_(nullptr),
-      enable_page_protections_(true) {
+      enable_page_protections_(true),
+      allocation_count_(0),
+      free_count_(0),
+      quarantine_push_count_(0),
+      quarantine_pop_count_(0),
+      quarantine_trim_count_(0) {
   DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
   DCHECK_NE(static_cast<StackCaptureCache*>(nullptr), stack_cache);
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
   SetDefaultAsanParameters(&parameters_);
+  ::memset(allocation_size_class_counts_, 0,
+           sizeof(allocation_size_class_counts_));
+  ::memset(call_site_full_stack_counts_, 0,
+           sizeof(call_site_full_stack_counts_));
 
   // Initialize the allocation-filter flag (using Thread Local Storage).
   allocation_filter_flag_tls_ = ::TlsAlloc();
   CHECK_NE(TLS_OUT_OF_INDEXES, allocation_filter_flag_tls_);
   // And disable it by default.
   set_allocation_filter_flag(false);
+
+  sampling_countdown_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, sampling_countdown_tls_);
 }
 
 BlockHeapManager::~BlockHeapManager() {
@@ -122,6 +220,13 @@ void BlockHeapManager::Init() {
     base::AutoLock lock(lock_);
     InitInternalHeap();
 
+    // The heaps keep a pointer to the shared quarantine, so it can't be
+    // changed once they exist.
+    if (parameters_.enable_size_class_quarantine)
+      shared_quarantine_ = &size_class_quarantine_;
+    else if (parameters_.enable_per_cpu_quarantine)
+      shared_quarantine_ = &per_cpu_quarantine_;
+
     // Only create a registry cache if the registry is available. It is not
     // available in sandboxed Chrome renderer processes.
     if (RegistryCache::RegistryAvailable()) {
@@ -153,7 +258,7 @@ HeapId BlockHeapManager::CreateHeap() {
 
   base::AutoLock lock(lock_);
   underlying_heaps_map_.insert(std::make_pair(heap, underlying_heap));
-  HeapMetadata metadata = { &shared_quarantine_, false };
+  HeapMetadata metadata = { shared_quarantine_, false };
   auto result = heaps_.insert(std::make_pair(heap, metadata));
   return GetHeapId(result);
 }
@@ -192,24 +297,39 @@ void* BlockHeapManager::Allocate(HeapId heap_id, uint32_t bytes) {
   DCHECK(initialized_);
   DCHECK(IsValidHeapId(heap_id, false));
 
+  IncrementCounter(&allocation_count_, 1);
+  IncrementCounter(&allocation_size_class_counts_[
+      GetAllocationSizeClass(bytes)], 1);
+
   // Some allocations can pass through without instrumentation.
-  if (parameters_.allocation_guard_rate < 1.0 &&
-      base::RandDouble() >= parameters_.allocation_guard_rate) {
+  if (!ShouldGuardAllocation())
     return DoUnguardedAllocation(GetHeapFromId(heap_id), shadow_, bytes);
-  }
 
   // Capture the current stack. InitFromStack is inlined to preserve the
-  // greatest number of stack frames.
-  common::StackCapture stack;
-  stack.InitFromStack();
+  // greatest number of stack frames. When full stacks are sampled, the
+  // fingerprint of the call site is captured instead if it isn't selected.
+  common::StackCapture stack(GetStackCaptureDepth(stack_cache_));
+  common::StackCapture fingerprint(kStackFingerprintDepth);
+  const common::StackCapture* alloc_stack = &stack;
+  if (SamplesFullStacks() && CaptureStackFingerprint(&fingerprint) &&
+      !ShouldCaptureFullStack(fingerprint)) {
+    alloc_stack = &fingerprint;
+  } else {
+    stack.InitFromStack();
+  }
 
   // Build the set of heaps that will be used to satisfy the allocation. This
   // is a stack of heaps, and they will be tried in the reverse order they are
   // inserted.
 
   // We can always use the heap that was passed in.
-  HeapId heaps[3] = { heap_id, 0, 0 };
+  HeapId heaps[4] = { heap_id, 0, 0, 0 };
   size_t heap_count = 1;
+  if (MayUseSlabBlockHeap(bytes)) {
+    DCHECK_LT(heap_count, arraysize(heaps));
+    heaps[heap_count++] = slab_block_heap_id_;
+  }
+
   if (MayUseLargeBlockHeap(bytes)) {
     DCHECK_LT(heap_count, arraysize(heaps));
     heaps[heap_count++] = large_block_heap_id_;
@@ -225,11 +345,7 @@ void* BlockHeapManager::Allocate(HeapId heap_id, uint32_t bytes) {
   BlockLayout block_layout = {};
   for (int i = static_cast<int>(heap_count) - 1; i >= 0; --i) {
     BlockHeapInterface* heap = GetHeapFromId(heaps[i]);
-    alloc = heap->AllocateBlock(
-        bytes,
-        0,
-        parameters_.trailer_padding_size + sizeof(BlockTrailer),
-        &block_layout);
+    alloc = AllocateBlockFromHeap(heap, bytes, &block_layout);
     if (alloc != nullptr) {
       heap_id = heaps[i];
       break;
@@ -249,7 +365,7 @@ void* BlockHeapManager::Allocate(HeapId heap_id, uint32_t bytes) {
   // Poison the redzones in the shadow memory as early as possible.
   shadow_->PoisonAllocatedBlock(block);
 
-  block.header->alloc_stack = stack_cache_->SaveStackTrace(stack);
+  block.header->alloc_stack = stack_cache_->SaveStackTrace(*alloc_stack);
   block.header->free_stack = nullptr;
   block.header->state = ALLOCATED_BLOCK;
 
@@ -270,6 +386,8 @@ bool BlockHeapManager::Free(HeapId heap_id, void* alloc) {
   if (alloc == nullptr)
     return true;
 
+  IncrementCounter(&free_count_, 1);
+
   BlockInfo block_info = {};
   if (!shadow_->IsBeginningOfBlockBody(alloc) ||
       !GetBlockInfo(shadow_, reinterpret_cast<BlockBody*>(alloc),
@@ -310,10 +428,16 @@ bool BlockHeapManager::Free(HeapId heap_id, void* alloc) {
   // We need to update the block's metadata before pushing it into the
   // quarantine, otherwise a concurrent thread might try to pop it while its in
   // an invalid state.
-  common::StackCapture stack;
-  stack.InitFromStack();
-  block_info.header->free_stack =
-      stack_cache_->SaveStackTrace(stack);
+  common::StackCapture stack(GetStackCaptureDepth(stack_cache_));
+  common::StackCapture fingerprint(kStackFingerprintDepth);
+  const common::StackCapture* free_stack = &stack;
+  if (SamplesFullStacks() && CaptureStackFingerprint(&fingerprint) &&
+      !ShouldCaptureFullStack(fingerprint)) {
+    free_stack = &fingerprint;
+  } else {
+    stack.InitFromStack();
+  }
+  block_info.header->free_stack = stack_cache_->SaveStackTrace(*free_stack);
   block_info.trailer->free_ticks = ::GetTickCount();
   block_info.trailer->free_tid = ::GetCurrentThreadId();
 
@@ -334,6 +458,15 @@ bool BlockHeapManager::Free(HeapId heap_id, void* alloc) {
   CompactBlockInfo compact = {};
   ConvertBlockInfo(block_info, &compact);
 
+  // The block is protected before being pushed into the quarantine. Some
+  // quarantines don't hold a lock across the push, so the block may be popped
+  // and freed by a concurrent thread as soon as it has been pushed; protecting
+  // it afterwards could end up protecting a free (not quarantined, not
+  // allocated) block. If the push fails FreePristineBlock takes care of
+  // removing the protection.
+  if (enable_page_protections_)
+    BlockProtectAll(block_info, shadow_);
+
   PushResult push_result = {};
   {
     BlockQuarantineInterface::AutoQuarantineLock quarantine_lock(
@@ -343,16 +476,8 @@ bool BlockHeapManager::Free(HeapId heap_id, void* alloc) {
       TrimOrScheduleIfNecessary(push_result.trim_status, quarantine);
       return FreePristineBlock(&block_info);
     }
-
-    if (enable_page_protections_) {
-      // The recently pushed block can be popped out in TrimQuarantine if the
-      // quarantine size is 0, in that case TrimQuarantine takes care of
-      // properly unprotecting and freeing the block. If the protection is set
-      // blindly after TrimQuarantine we could end up protecting a free (not
-      // quarantined, not allocated) block.
-      BlockProtectAll(block_info, shadow_);
-    }
   }
+  IncrementCounter(&quarantine_push_count_, 1);
 
   TrimOrScheduleIfNecessary(push_result.trim_status, quarantine);
 
@@ -381,6 +506,81 @@ uint32_t BlockHeapManager::Size(HeapId heap_id, const void* alloc) {
   }
 }
 
+bool BlockHeapManager::ResizeInPlace(HeapId heap_id,
+                                     void* alloc,
+                                     uint32_t bytes) {
+  DCHECK(initialized_);
+  DCHECK(IsValidHeapId(heap_id, false));
+  DCHECK_NE(static_cast<void*>(nullptr), alloc);
+
+  BlockInfo block_info = {};
+  if (!shadow_->IsBeginningOfBlockBody(alloc) ||
+      !GetBlockInfo(shadow_, reinterpret_cast<BlockBody*>(alloc),
+                    &block_info)) {
+    return false;
+  }
+
+  if (enable_page_protections_)
+    BlockProtectNone(block_info, shadow_);
+
+  // Corrupt and freed blocks are left to the fallback, which reports them.
+  // The blocks of the zebra and large block heaps are laid out relative to
+  // page boundaries, which resizing them in place would break.
+  bool resized = false;
+  BlockLayout layout = {};
+  if (BlockChecksumIsValid(block_info) &&
+      block_info.header->state == ALLOCATED_BLOCK &&
+      block_info.trailer->heap_id != zebra_block_heap_id_ &&
+      block_info.trailer->heap_id != large_block_heap_id_ &&
+      // Plan the smallest block holding the new body after the current
+      // header, which keeps the body where it is. It has to fit in the
+      // existing block.
+      BlockPlanLayout(kShadowRatio, kShadowRatio, bytes,
+                      block_info.TotalHeaderSize(),
+                      parameters_.trailer_padding_size + sizeof(BlockTrailer),
+                      &layout) &&
+      layout.block_size <= block_info.block_size) {
+    DCHECK_EQ(block_info.header_padding_size, layout.header_padding_size);
+
+    // Capture the current stack, as the resized block is a new allocation.
+    common::StackCapture stack(GetStackCaptureDepth(stack_cache_));
+    common::StackCapture fingerprint(kStackFingerprintDepth);
+    const common::StackCapture* alloc_stack = &stack;
+    if (SamplesFullStacks() && CaptureStackFingerprint(&fingerprint) &&
+        !ShouldCaptureFullStack(fingerprint)) {
+      alloc_stack = &fingerprint;
+    } else {
+      stack.InitFromStack();
+    }
+
+    // The trailer padding takes up the slack in the existing block.
+    layout.trailer_padding_size += block_info.block_size - layout.block_size;
+    layout.block_size = block_info.block_size;
+
+    const common::StackCapture* old_alloc_stack =
+        block_info.header->alloc_stack;
+    size_t block_heap_id = block_info.trailer->heap_id;
+    BlockInitialize(layout, block_info.header, &block_info);
+    shadow_->PoisonAllocatedBlock(block_info);
+
+    block_info.header->alloc_stack = stack_cache_->SaveStackTrace(*alloc_stack);
+    block_info.trailer->heap_id = block_heap_id;
+    BlockSetChecksum(block_info);
+    if (old_alloc_stack != nullptr)
+      stack_cache_->ReleaseStackTrace(old_alloc_stack);
+    resized = true;
+  }
+
+  if (enable_page_protections_) {
+    if (block_info.header->state == ALLOCATED_BLOCK)
+      BlockProtectRedzones(block_info, shadow_);
+    else
+      BlockProtectAll(block_info, shadow_);
+  }
+
+  return resized;
+}
+
 void BlockHeapManager::Lock(HeapId heap_id) {
   DCHECK(initialized_);
   DCHECK(IsValidHeapId(heap_id, false));
@@ -431,11 +631,18 @@ void BlockHeapManager::UnlockAll() {
 
 void BlockHeapManager::set_parameters(
     const ::common::AsanParameters& parameters) {
+  bool redzones_changed = false;
   {
     base::AutoLock lock(lock_);
+    redzones_changed =
+        parameters.trailer_padding_size != parameters_.trailer_padding_size;
     parameters_ = parameters;
   }
 
+  // The memoized block layouts are for the previous redzone sizes.
+  if (redzones_changed)
+    BlockLayoutCacheInvalidate();
+
   // Releases the lock before propagating the parameters.
   if (initialized_)
     PropagateParameters();
@@ -462,6 +669,9 @@ void BlockHeapManager::TearDownHeapManager() {
   // Clear the active heap list.
   heaps_.clear();
 
+  // The thread caches no longer reference any heap.
+  thread_local_block_cache_.reset();
+
   // Clear the specialized heap references since they were deleted.
   process_heap_ = nullptr;
   process_heap_underlying_heap_ = nullptr;
@@ -469,12 +679,18 @@ void BlockHeapManager::TearDownHeapManager() {
   zebra_block_heap_ = nullptr;
   zebra_block_heap_id_ = 0;
   large_block_heap_id_ = 0;
+  slab_block_heap_id_ = 0;
 
   // Free the allocation-filter flag (TLS).
   if (allocation_filter_flag_tls_ != TLS_OUT_OF_INDEXES) {
     ::TlsFree(allocation_filter_flag_tls_);
     allocation_filter_flag_tls_ = TLS_OUT_OF_INDEXES;
   }
+
+  if (sampling_countdown_tls_ != TLS_OUT_OF_INDEXES) {
+    ::TlsFree(sampling_countdown_tls_);
+    sampling_countdown_tls_ = TLS_OUT_OF_INDEXES;
+  }
 }
 
 HeapId BlockHeapManager::GetHeapId(
@@ -588,19 +804,23 @@ void BlockHeapManager::PropagateParameters() {
   // The internal heap should already be setup.
   DCHECK_NE(static_cast<HeapInterface*>(nullptr), internal_heap_.get());
 
-  size_t quarantine_size = shared_quarantine_.max_quarantine_size();
-  shared_quarantine_.set_max_quarantine_size(parameters_.quarantine_size);
-  shared_quarantine_.set_max_object_size(parameters_.quarantine_block_size);
+  size_t quarantine_size = shared_quarantine_->max_quarantine_size();
+  shared_quarantine_->set_max_quarantine_size(parameters_.quarantine_size);
+  shared_quarantine_->set_max_object_size(parameters_.quarantine_block_size);
 
   // Trim the quarantine if its maximum size has decreased.
   if (initialized_ && quarantine_size > parameters_.quarantine_size)
-    TrimQuarantine(TrimColor::YELLOW, &shared_quarantine_);
+    TrimQuarantine(TrimColor::YELLOW, shared_quarantine_);
 
   if (parameters_.enable_zebra_block_heap && zebra_block_heap_ == nullptr) {
     // Initialize the zebra heap only if it isn't already initialized.
-    // The zebra heap cannot be resized once created.
+    // The zebra heap grows on demand, but its region size and maximum region
+    // count cannot be changed once created.
     base::AutoLock lock(lock_);
+    size_t region_count =
+        std::max<size_t>(1, parameters_.zebra_block_heap_region_count);
     zebra_block_heap_ = new ZebraBlockHeap(parameters_.zebra_block_heap_size,
+                                           region_count,
                                            memory_notifier_,
                                            internal_heap_.get());
     // The zebra block heap is its own quarantine.
@@ -617,16 +837,36 @@ void BlockHeapManager::PropagateParameters() {
       TrimQuarantine(TrimColor::YELLOW, zebra_block_heap_);
   }
 
+  // Create the thread local block cache if need be. Once created it is kept
+  // alive as it may still contain blocks, but it is only used for new
+  // allocations while the parameter is set.
+  if (parameters_.enable_thread_local_block_cache &&
+      thread_local_block_cache_.get() == nullptr) {
+    base::AutoLock lock(lock_);
+    thread_local_block_cache_.reset(
+        new ThreadLocalBlockCache(internal_heap_.get()));
+  }
+
   // Create the LargeBlockHeap if need be.
   if (parameters_.enable_large_block_heap && large_block_heap_id_ == 0) {
     base::AutoLock lock(lock_);
     BlockHeapInterface* heap = new LargeBlockHeap(
         memory_notifier_, internal_heap_.get());
-    HeapMetadata metadata = { &shared_quarantine_, false };
+    HeapMetadata metadata = { shared_quarantine_, false };
     auto result = heaps_.insert(std::make_pair(heap, metadata));
     large_block_heap_id_ = GetHeapId(result);
   }
 
+  // Create the SlabBlockHeap if need be.
+  if (parameters_.enable_slab_block_heap && slab_block_heap_id_ == 0) {
+    base::AutoLock lock(lock_);
+    BlockHeapInterface* heap = new SlabBlockHeap(
+        memory_notifier_, internal_heap_.get());
+    HeapMetadata metadata = { shared_quarantine_, false };
+    auto result = heaps_.insert(std::make_pair(heap, metadata));
+    slab_block_heap_id_ = GetHeapId(result);
+  }
+
   // TODO(chrisha|sebmarchand): Clean up existing blocks that exceed the
   //     maximum block size? This will require an entirely new TrimQuarantine
   //     function. Since this is never changed at runtime except in our
@@ -641,6 +881,11 @@ void BlockHeapManager::set_allocation_filter_flag(bool value) {
   ::TlsSetValue(allocation_filter_flag_tls_, reinterpret_cast<void*>(value));
 }
 
+void BlockHeapManager::FlushThreadLocalBlockCache() {
+  if (thread_local_block_cache_.get() != nullptr)
+    thread_local_block_cache_->FlushThread();
+}
+
 void BlockHeapManager::EnableDeferredFreeThread() {
   // The thread will be shutdown before this BlockHeapManager object is
   // destroyed, so passing |this| unretained is safe.
@@ -651,27 +896,66 @@ void BlockHeapManager::EnableDeferredFreeThread() {
 void BlockHeapManager::DisableDeferredFreeThread() {
   DCHECK(IsDeferredFreeThreadRunning());
 
-  // Reset |deferred_free_thread_| which disables the features. This is done
-  // before stopping the feature as to avoid locking |deferred_free_thread_old|
-  // while joining the thread, which can lead to a deadlock. The old value is
-  // preserved as it is needed to stop the thread.
-  std::unique_ptr<DeferredFreeThread> deferred_free_thread_old;
+  // Reset |deferred_free_threads_| which disables the features. This is done
+  // before stopping the feature as to avoid locking |deferred_free_threads_|
+  // while joining the threads, which can lead to a deadlock. The old value is
+  // preserved as it is needed to stop the threads.
+  std::vector<std::unique_ptr<DeferredFreeThread>> deferred_free_threads_old;
   {
     base::AutoLock lock(deferred_free_thread_lock_);
-    deferred_free_thread_old.swap(deferred_free_thread_);
+    deferred_free_threads_old.swap(deferred_free_threads_);
   }
 
-  // Stop the thread and wait for it to exit.
-  if (deferred_free_thread_old)
-    deferred_free_thread_old->Stop();
+  // Stop the threads and wait for them to exit.
+  for (auto& deferred_free_thread : deferred_free_threads_old)
+    deferred_free_thread->Stop();
 
   // Set the overbudget size to 0 to remove the hysteresis.
-  shared_quarantine_.SetOverbudgetSize(0);
+  shared_quarantine_->SetOverbudgetSize(0);
 }
 
 bool BlockHeapManager::IsDeferredFreeThreadRunning() {
   base::AutoLock lock(deferred_free_thread_lock_);
-  return deferred_free_thread_ != nullptr;
+  return !deferred_free_threads_.empty();
+}
+
+void BlockHeapManager::GetStatistics(AsanRuntimeStatistics* statistics) {
+  DCHECK(initialized_);
+  DCHECK_NE(static_cast<AsanRuntimeStatistics*>(nullptr), statistics);
+
+  statistics->allocations = base::subtle::NoBarrier_Load(&allocation_count_);
+  statistics->frees = base::subtle::NoBarrier_Load(&free_count_);
+  for (size_t i = 0; i < AsanRuntimeStatistics::kSizeClassCount; ++i) {
+    statistics->allocation_size_classes[i] =
+        base::subtle::NoBarrier_Load(&allocation_size_class_counts_[i]);
+  }
+  statistics->quarantine_pushes =
+      base::subtle::NoBarrier_Load(&quarantine_push_count_);
+  statistics->quarantine_pops =
+      base::subtle::NoBarrier_Load(&quarantine_pop_count_);
+  statistics->quarantine_trims =
+      base::subtle::NoBarrier_Load(&quarantine_trim_count_);
+
+  // Reading the lock statistics of a heap doesn't acquire its lock, so this
+  // can be called while the heaps are busy.
+  base::AutoLock lock(lock_);
+  statistics->heap_count = 0;
+  for (auto& heap_quarantine_pair : heaps_) {
+    if (statistics->heap_count == AsanRuntimeStatistics::kMaxHeapCount)
+      break;
+    HeapInterface* heap = heap_quarantine_pair.first;
+    ::common::RecursiveLock::Statistics lock_statistics = {};
+    if (!heap->GetLockStatistics(&lock_statistics))
+      continue;
+    AsanHeapLockStatistics* heap_statistics =
+        &statistics->heaps[statistics->heap_count++];
+    heap_statistics->heap_type = heap->GetHeapType();
+    heap_statistics->acquisitions =
+        static_cast<uint32_t>(lock_statistics.acquisitions);
+    heap_statistics->contentions =
+        static_cast<uint32_t>(lock_statistics.contentions);
+    heap_statistics->wait_time_us = lock_statistics.wait_time.InMicroseconds();
+  }
 }
 
 HeapType BlockHeapManager::GetHeapTypeUnlocked(HeapId heap_id) {
@@ -717,19 +1001,26 @@ bool BlockHeapManager::DestroyHeapContents(
     }
   }
 
+  // Return the blocks cached by all the threads to the heap, so that they are
+  // released along with it.
+  if (thread_local_block_cache_.get() != nullptr &&
+      ThreadLocalBlockCache::IsCacheableHeap(heap)) {
+    thread_local_block_cache_->FlushHeap(heap);
+  }
+
   // Restore the blocks that don't belong to this quarantine.
   for (const auto& iter_block : blocks_to_reinsert) {
     BlockInfo expanded = {};
     ConvertBlockInfo(iter_block, &expanded);
 
+    // Restore protection to the block before it becomes visible to other
+    // threads through the quarantine.
+    if (enable_page_protections_)
+      BlockProtectAll(expanded, shadow_);
+
     BlockQuarantineInterface::AutoQuarantineLock quarantine_lock(quarantine,
                                                                  iter_block);
-    if (quarantine->Push(iter_block).push_successful) {
-      if (enable_page_protections_) {
-        // Restore protection to quarantined block.
-        BlockProtectAll(expanded, shadow_);
-      }
-    } else {
+    if (!quarantine->Push(iter_block).push_successful) {
       // Avoid memory leak.
       FreeBlock(iter_block);
     }
@@ -759,21 +1050,44 @@ void BlockHeapManager::TrimQuarantine(TrimColor stop_color,
   DCHECK(initialized_);
   DCHECK_NE(static_cast<BlockQuarantineInterface*>(nullptr), quarantine);
 
+  IncrementCounter(&quarantine_trim_count_, 1);
+
   // Trim the quarantine to the required color.
   if (parameters_.quarantine_size == 0) {
     BlockQuarantineInterface::ObjectVector blocks_to_free;
     quarantine->Empty(&blocks_to_free);
+    IncrementCounter(&quarantine_pop_count_, blocks_to_free.size());
+    // Freeing the blocks finds them already unprotected.
+    if (enable_page_protections_ && !blocks_to_free.empty()) {
+      UnprotectBlocks(blocks_to_free.data(), blocks_to_free.size(),
+                      shadow_);
+    }
     for (const auto& block : blocks_to_free)
       FreeBlock(block);
   } else {
-    CompactBlockInfo compact = {};
-    while (true) {
-      PopResult result = quarantine->Pop(&compact);
-      if (!result.pop_successful)
-        break;
-      FreeBlock(compact);
-      if (result.trim_color <= stop_color)
-        break;
+    static const size_t kBatchSize = 32;
+    CompactBlockInfo batch[kBatchSize];
+    bool done = false;
+    while (!done) {
+      size_t count = 0;
+      while (count < kBatchSize) {
+        PopResult result = quarantine->Pop(&batch[count]);
+        if (!result.pop_successful) {
+          done = true;
+          break;
+        }
+        ++count;
+        if (result.trim_color <= stop_color) {
+          done = true;
+          break;
+        }
+      }
+      IncrementCounter(&quarantine_pop_count_, count);
+      // Freeing the blocks finds them already unprotected.
+      if (enable_page_protections_)
+        UnprotectBlocks(batch, count, shadow_);
+      for (size_t i = 0; i < count; ++i)
+        FreeBlock(batch[i]);
     }
   }
 }
@@ -839,13 +1153,15 @@ bool BlockHeapManager::FreeCorruptBlock(BlockInfo* block_info) {
 bool BlockHeapManager::FreePristineBlock(BlockInfo* block_info) {
   DCHECK(initialized_);
   DCHECK_NE(static_cast<BlockInfo*>(nullptr), block_info);
-  BlockHeapInterface* heap = GetHeapFromId(block_info->trailer->heap_id);
 
   if (enable_page_protections_) {
-    // Remove block protections so the redzones may be modified.
+    // Remove block protections so the redzones may be modified. This must
+    // happen before reading the trailer, as the block may be protected.
     BlockProtectNone(*block_info, shadow_);
   }
 
+  BlockHeapInterface* heap = GetHeapFromId(block_info->trailer->heap_id);
+
   // Return pointers to the stacks for reference counting purposes.
   if (block_info->header->alloc_stack != nullptr) {
     stack_cache_->ReleaseStackTrace(block_info->header->alloc_stack);
@@ -866,7 +1182,7 @@ bool BlockHeapManager::FreePristineBlock(BlockInfo* block_info) {
   } else {
     shadow_->Unpoison(block_info->header, block_info->block_size);
   }
-  return heap->FreeBlock(*block_info);
+  return FreeBlockToHeap(heap, *block_info);
 }
 
 bool BlockHeapManager::FreeUnguardedAlloc(HeapId heap_id, void* alloc) {
@@ -947,11 +1263,48 @@ void BlockHeapManager::InitProcessHeap() {
   process_heap_ = new heaps::SimpleBlockHeap(process_heap_underlying_heap_);
   underlying_heaps_map_.insert(std::make_pair(process_heap_,
                                               process_heap_underlying_heap_));
-  HeapMetadata heap_metadata = { &shared_quarantine_, false };
+  HeapMetadata heap_metadata = { shared_quarantine_, false };
   auto result = heaps_.insert(std::make_pair(process_heap_, heap_metadata));
   process_heap_id_ = GetHeapId(result);
 }
 
+bool BlockHeapManager::ShouldGuardAllocation() {
+  if (parameters_.allocation_guard_rate >= 1.0)
+    return true;
+  if (!parameters_.enable_sampled_allocation_guards)
+    return base::RandDouble() < parameters_.allocation_guard_rate;
+  if (parameters_.allocation_guard_rate <= 0.0)
+    return false;
+
+  size_t countdown =
+      reinterpret_cast<size_t>(::TlsGetValue(sampling_countdown_tls_));
+  if (countdown == 0)
+    countdown = GetSamplingInterval(parameters_.allocation_guard_rate);
+  --countdown;
+  ::TlsSetValue(sampling_countdown_tls_, reinterpret_cast<void*>(countdown));
+  return countdown == 0;
+}
+
+bool BlockHeapManager::ShouldCaptureFullStack(
+    const common::StackCapture& fingerprint) {
+  uint32_t per_site = parameters_.full_stack_captures_per_site;
+  if (per_site > 0) {
+    base::subtle::Atomic32* count = &call_site_full_stack_counts_[
+        fingerprint.absolute_stack_id() % kCallSiteCountTableSize];
+    // Check before incrementing, so that the count of a busy call site stops
+    // growing once it has been captured enough.
+    if (static_cast<uint32_t>(base::subtle::NoBarrier_Load(count)) <
+            per_site &&
+        static_cast<uint32_t>(base::subtle::NoBarrier_AtomicIncrement(
+            count, 1)) <= per_site) {
+      return true;
+    }
+  }
+  if (parameters_.full_stack_capture_rate <= 0.0f)
+    return false;
+  return base::RandDouble() < parameters_.full_stack_capture_rate;
+}
+
 bool BlockHeapManager::MayUseLargeBlockHeap(size_t bytes) const {
   DCHECK(initialized_);
   if (!parameters_.enable_large_block_heap)
@@ -959,6 +1312,10 @@ bool BlockHeapManager::MayUseLargeBlockHeap(size_t bytes) const {
   if (bytes >= parameters_.large_allocation_threshold)
     return true;
 
+  // Sampled guarded allocations are all placed in page protected slots.
+  if (parameters_.enable_sampled_allocation_guards)
+    return true;
+
   // If we get here we're treating a small allocation. If the allocation
   // filter is in effect and the flag set then allow it.
   if (parameters_.enable_allocation_filter && allocation_filter_flag())
@@ -974,6 +1331,10 @@ bool BlockHeapManager::MayUseZebraBlockHeap(size_t bytes) const {
   if (bytes > ZebraBlockHeap::kMaximumBlockAllocationSize)
     return false;
 
+  // Sampled guarded allocations are all placed in page protected slots.
+  if (parameters_.enable_sampled_allocation_guards)
+    return true;
+
   // If the allocation filter is in effect only allow filtered allocations
   // into the zebra heap.
   if (parameters_.enable_allocation_filter)
@@ -983,6 +1344,14 @@ bool BlockHeapManager::MayUseZebraBlockHeap(size_t bytes) const {
   return true;
 }
 
+bool BlockHeapManager::MayUseSlabBlockHeap(size_t bytes) const {
+  DCHECK(initialized_);
+  if (!parameters_.enable_slab_block_heap)
+    return false;
+  // The block of a bigger allocation can't fit in a slot.
+  return bytes < SlabBlockHeap::kMaximumAllocationSize;
+}
+
 bool BlockHeapManager::ShouldReportCorruptBlock(const BlockInfo* block_info) {
   DCHECK_NE(static_cast<const BlockInfo*>(nullptr), block_info);
 
@@ -1035,35 +1404,78 @@ void BlockHeapManager::TrimOrScheduleIfNecessary(
 void BlockHeapManager::DeferredFreeThreadSignalWork() {
   DCHECK(IsDeferredFreeThreadRunning());
   base::AutoLock lock(deferred_free_thread_lock_);
-  deferred_free_thread_->SignalWork();
+  // All the threads are woken up. They pop from random shards of the
+  // quarantine, and stop as soon as it is back in the GREEN color.
+  for (auto& deferred_free_thread : deferred_free_threads_)
+    deferred_free_thread->SignalWork();
 }
 
 void BlockHeapManager::DeferredFreeDoWork() {
-  DCHECK_EQ(GetDeferredFreeThreadId(), base::PlatformThread::CurrentId());
+  DCHECK(IsDeferredFreeThreadId(base::PlatformThread::CurrentId()));
   // As of now, only the shared quarantine gets trimmed asynchronously. This
   // will bring it back in the GREEN color.
-  BlockQuarantineInterface* shared_quarantine = &shared_quarantine_;
-  TrimQuarantine(TrimColor::GREEN, shared_quarantine);
+  TrimQuarantine(TrimColor::GREEN, shared_quarantine_);
 }
 
-base::PlatformThreadId BlockHeapManager::GetDeferredFreeThreadId() {
+bool BlockHeapManager::IsDeferredFreeThreadId(
+    base::PlatformThreadId thread_id) {
   DCHECK(IsDeferredFreeThreadRunning());
   base::AutoLock lock(deferred_free_thread_lock_);
-  return deferred_free_thread_->deferred_free_thread_id();
+  for (auto& deferred_free_thread : deferred_free_threads_) {
+    if (deferred_free_thread->deferred_free_thread_id() == thread_id)
+      return true;
+  }
+  return false;
+}
+
+size_t BlockHeapManager::GetDeferredFreeThreadCount() {
+  base::AutoLock lock(deferred_free_thread_lock_);
+  return deferred_free_threads_.size();
 }
 
 void BlockHeapManager::EnableDeferredFreeThreadWithCallback(
     DeferredFreeThread::Callback deferred_free_callback) {
   DCHECK(!IsDeferredFreeThreadRunning());
 
-  shared_quarantine_.SetOverbudgetSize(
-      shared_quarantine_.max_quarantine_size() * kOverbudgetSizePercentage /
+  shared_quarantine_->SetOverbudgetSize(
+      shared_quarantine_->max_quarantine_size() * kOverbudgetSizePercentage /
       100);
 
-  // Create the thread and wait for it to start.
+  // Create the threads and wait for them to start.
+  size_t thread_count =
+      std::max<size_t>(1, parameters_.deferred_free_thread_count);
   base::AutoLock lock(deferred_free_thread_lock_);
-  deferred_free_thread_.reset(new DeferredFreeThread(deferred_free_callback));
-  deferred_free_thread_->Start();
+  for (size_t i = 0; i < thread_count; ++i) {
+    deferred_free_threads_.push_back(std::unique_ptr<DeferredFreeThread>(
+        new DeferredFreeThread(deferred_free_callback)));
+    deferred_free_threads_.back()->Start();
+  }
+}
+
+void* BlockHeapManager::AllocateBlockFromHeap(BlockHeapInterface* heap,
+                                              uint32_t bytes,
+                                              BlockLayout* layout) {
+  DCHECK_NE(static_cast<BlockHeapInterface*>(nullptr), heap);
+  uint32_t min_right_redzone_size =
+      parameters_.trailer_padding_size + sizeof(BlockTrailer);
+  if (parameters_.enable_thread_local_block_cache &&
+      thread_local_block_cache_.get() != nullptr &&
+      ThreadLocalBlockCache::IsCacheableHeap(heap)) {
+    return thread_local_block_cache_->AllocateBlock(
+        heap, bytes, 0, min_right_redzone_size, layout);
+  }
+  return heap->AllocateBlock(bytes, 0, min_right_redzone_size, layout);
+}
+
+bool BlockHeapManager::FreeBlockToHeap(BlockHeapInterface* heap,
+                                       const BlockInfo& block_info) {
+  DCHECK_NE(static_cast<BlockHeapInterface*>(nullptr), heap);
+  if (parameters_.enable_thread_local_block_cache &&
+      thread_local_block_cache_.get() != nullptr &&
+      ThreadLocalBlockCache::IsCacheableHeap(heap)) {
+    return thread_local_block_cache_->FreeBlock(heap, block_info);
+  }
+  return heap->FreeBlock(block_info);
 }
 
 HeapId BlockHeapManager::GetCorruptBlockHeapId(const BlockInfo* block_info) {
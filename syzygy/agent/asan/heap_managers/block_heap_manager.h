@@ -22,7 +22,9 @@
 #include <memory>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "base/atomicops.h"
 #include "base/logging.h"
 #include "syzygy/agent/asan/block_utils.h"
 #include "syzygy/agent/asan/error_info.h"
@@ -30,10 +32,14 @@
 #include "syzygy/agent/asan/heap_manager.h"
 #include "syzygy/agent/asan/quarantine.h"
 #include "syzygy/agent/asan/registry_cache.h"
+#include "syzygy/agent/asan/runtime_statistics.h"
 #include "syzygy/agent/asan/stack_capture_cache.h"
 #include "syzygy/agent/asan/heap_managers/deferred_free_thread.h"
+#include "syzygy/agent/asan/heap_managers/thread_local_block_cache.h"
 #include "syzygy/agent/asan/memory_notifiers/shadow_memory_notifier.h"
+#include "syzygy/agent/asan/quarantines/per_cpu_quarantine.h"
 #include "syzygy/agent/asan/quarantines/sharded_quarantine.h"
+#include "syzygy/agent/asan/quarantines/size_class_quarantine.h"
 #include "syzygy/agent/common/stack_capture.h"
 #include "syzygy/common/asan_parameters.h"
 
@@ -89,6 +95,7 @@ class BlockHeapManager : public HeapManagerInterface {
    void* Allocate(HeapId heap_id, uint32_t bytes) override;
    bool Free(HeapId heap_id, void* alloc) override;
    uint32_t Size(HeapId heap_id, const void* alloc) override;
+  bool ResizeInPlace(HeapId heap_id, void* alloc, uint32_t bytes) override;
    void Lock(HeapId heap_id) override;
    void Unlock(HeapId heap_id) override;
    void BestEffortLockAll() override;
@@ -129,7 +136,9 @@ class BlockHeapManager : public HeapManagerInterface {
 
   // Enables the deferred free thread mechanism. Must not be called if the
   // thread is already running. Typical usage is to enable the thread at startup
-  // and disable it at shutdown.
+  // and disable it at shutdown. This starts as many threads as specified by
+  // parameters_.deferred_free_thread_count, which all trim the shared
+  // quarantine when signaled.
   void EnableDeferredFreeThread();
 
   // Disables the deferred free thread mechanism. Must be called before the
@@ -140,6 +149,16 @@ class BlockHeapManager : public HeapManagerInterface {
   // @returns true if the deferred thread is currently running.
   bool IsDeferredFreeThreadRunning();
 
+  // Returns the blocks held in the calling thread's local block cache to
+  // their heaps. This is meant to be called when a thread exits.
+  void FlushThreadLocalBlockCache();
+
+  // Gets the statistics describing the activity of this heap manager. This
+  // fills in the allocation, quarantine and heap lock statistics, and leaves
+  // the other fields alone.
+  // @param statistics Will receive the statistics.
+  void GetStatistics(AsanRuntimeStatistics* statistics);
+
  protected:
   // This allows the runtime access to our internals, necessary for crash
   // processing.
@@ -151,12 +170,23 @@ class BlockHeapManager : public HeapManagerInterface {
   HeapType GetHeapTypeUnlocked(HeapId heap_id);
   // @}
 
-  // The type of quarantine that we use internally.
+  // The types of quarantine that we use internally. They share a common base
+  // class, which is used when the type doesn't matter.
+  using SharedBlockQuarantine =
+      quarantines::SizeLimitedQuarantineImpl<CompactBlockInfo,
+                                             GetTotalBlockSizeFunctor>;
   using ShardedBlockQuarantine =
       quarantines::ShardedQuarantine<CompactBlockInfo,
                                      GetTotalBlockSizeFunctor,
                                      GetBlockHashFunctor,
                                      kQuarantineDefaultShardingFactor>;
+  using PerCpuBlockQuarantine =
+      quarantines::PerCpuQuarantine<CompactBlockInfo,
+                                    GetTotalBlockSizeFunctor,
+                                    kQuarantineMaxProcessorCount>;
+  using SizeClassBlockQuarantine =
+      quarantines::SizeClassQuarantine<CompactBlockInfo,
+                                       GetTotalBlockSizeFunctor>;
 
   // A map associating a block heap with its underlying heap.
   using UnderlyingHeapMap =
@@ -252,7 +282,9 @@ class BlockHeapManager : public HeapManagerInterface {
                                     BlockQuarantineInterface* quarantine);
 
   // Trim the specified quarantine until its color is |stop_color| or lower. If
-  // parameters_.quarantine_size is 0 then the quarantine is flushed.
+  // parameters_.quarantine_size is 0 then the quarantine is flushed. Blocks
+  // are popped and freed in batches, so that concurrent trimmers don't
+  // alternate between the quarantine and heap locks for every block.
   // @param stop_color The target color at which the trimming ends.
   // @param quarantine The quarantine to trim.
   // TODO(peterssen): Change the 0-size contract. The quarantine 'contract'
@@ -316,6 +348,28 @@ class BlockHeapManager : public HeapManagerInterface {
   // Exposed for unittesting.
   void InitProcessHeap();
 
+  // Determines if an allocation should be guarded, as per the
+  // allocation_guard_rate parameter. With sampled allocation guards this uses
+  // a per-thread countdown to the next guarded allocation, so that most
+  // allocations don't need a random number.
+  // @returns true if the allocation should be guarded, false otherwise.
+  bool ShouldGuardAllocation();
+
+  // @returns true if only some allocations and frees have their full stack
+  //     captured, as per the full_stack_capture_rate parameter.
+  bool SamplesFullStacks() const {
+    return parameters_.full_stack_capture_rate < 1.0f;
+  }
+
+  // Determines if an allocation or a free should have its full stack captured,
+  // rather than only the fingerprint of its call site. The first
+  // full_stack_captures_per_site occurrences of each call site are always
+  // captured, the others as per the full_stack_capture_rate parameter.
+  // @param fingerprint The innermost frames of the stack of the allocation or
+  //     the free.
+  // @returns true if the full stack should be captured, false otherwise.
+  bool ShouldCaptureFullStack(const common::StackCapture& fingerprint);
+
   // Determines if the large block heap should be used for an allocation of
   // the given size.
   // @param bytes The allocation size.
@@ -330,6 +384,13 @@ class BlockHeapManager : public HeapManagerInterface {
   //     otherwise.
   bool MayUseZebraBlockHeap(size_t bytes) const;
 
+  // Determines if the slab block heap should be used for an allocation of
+  // the given size.
+  // @param bytes The allocation size.
+  // @returns true if the slab block heap should be used for this allocation,
+  //     false otherwise.
+  bool MayUseSlabBlockHeap(size_t bytes) const;
+
   // Indicates if a corrupt block error should be reported.
   // @param block_info The corrupt block.
   // @returns true if an error should be reported, false otherwise.
@@ -357,10 +418,30 @@ class BlockHeapManager : public HeapManagerInterface {
   void EnableDeferredFreeThreadWithCallback(
       DeferredFreeThread::Callback deferred_free_callback);
 
-  // Returns the ID of the deferred free thread. Must not be called if the
-  // thread is not running.
-  // @returns the thread ID.
-  base::PlatformThreadId GetDeferredFreeThreadId();
+  // Checks if a thread is one of the deferred free threads.
+  // @param thread_id The ID of the thread to check.
+  // @returns true if @p thread_id is the ID of a deferred free thread.
+  bool IsDeferredFreeThreadId(base::PlatformThreadId thread_id);
+
+  // @returns the number of running deferred free threads.
+  size_t GetDeferredFreeThreadCount();
+
+  // Allocates a block from a heap, going through the thread local block cache
+  // when it is enabled and supports the heap.
+  // @param heap The heap that should serve the allocation.
+  // @param bytes The size of the body of the allocation.
+  // @param layout The layout structure to be populated.
+  // @returns a pointer to the allocation upon success, otherwise nullptr.
+  void* AllocateBlockFromHeap(BlockHeapInterface* heap,
+                              uint32_t bytes,
+                              BlockLayout* layout);
+
+  // Returns a block to its heap, going through the thread local block cache
+  // when it is enabled and supports the heap.
+  // @param heap The heap that owns the block.
+  // @param block_info The block to be freed.
+  // @returns true on success, false otherwise.
+  bool FreeBlockToHeap(BlockHeapInterface* heap, const BlockInfo& block_info);
 
   // Helper function for finding the heap ID associated with a corrupt block.
   // This is best effort, and can return 0 when no heap can be found with
@@ -386,8 +467,14 @@ class BlockHeapManager : public HeapManagerInterface {
   HeapQuarantineMap heaps_;  // Under lock_.
 
   // The quarantine shared by the heaps created by this manager. This is also
-  // used by the LargeBlockHeap.
-  ShardedBlockQuarantine shared_quarantine_;
+  // used by the LargeBlockHeap. This points to one of the quarantines below,
+  // and is chosen once and for all in Init.
+  SharedBlockQuarantine* shared_quarantine_;
+
+  // The possible implementations of the shared quarantine.
+  ShardedBlockQuarantine sharded_quarantine_;
+  PerCpuBlockQuarantine per_cpu_quarantine_;
+  SizeClassBlockQuarantine size_class_quarantine_;
 
   // Map the block heaps to their underlying heap.
   UnderlyingHeapMap underlying_heaps_map_;  // Under lock_.
@@ -423,9 +510,17 @@ class BlockHeapManager : public HeapManagerInterface {
   // The ID of the large block heap. Allows accessing it directly.
   HeapId large_block_heap_id_;
 
+  // The ID of the slab block heap. Allows accessing it directly.
+  HeapId slab_block_heap_id_;
+
   // Stores the AllocationFilterFlag TLS slot.
   DWORD allocation_filter_flag_tls_;
 
+  // Stores the number of allocations left before the next guarded one for the
+  // current thread, when sampled allocation guards are enabled. Zero means
+  // that the countdown has to be restarted.
+  DWORD sampling_countdown_tls_;
+
   // A list of all heaps whose locks were acquired by the last call to
   // BestEffortLockAll. This uses the internal heap, otherwise the default
   // allocator makes use of the process heap. The process heap may itself
@@ -437,17 +532,38 @@ class BlockHeapManager : public HeapManagerInterface {
   // Indicates if we use page protection to prevent invalid accesses to a block.
   bool enable_page_protections_;
 
+  // The per-thread block cache sitting in front of the simple block heaps.
+  // This is only created when parameters_.enable_thread_local_block_cache is
+  // set, and is never torn down before the heap manager itself.
+  std::unique_ptr<ThreadLocalBlockCache> thread_local_block_cache_;
+
   // The registry cache that we use to store the allocation stack ID of the
   // corrupt block for which we've already reported an error. This isn't used
   // in processes where registry access is blocked (ie, Chrome renderers).
   std::unique_ptr<RegistryCache> corrupt_block_registry_cache_;
 
+  // The counters reported by GetStatistics. These are updated with relaxed
+  // atomic increments, so that they are cheap enough to always be on.
+  base::subtle::Atomic32 allocation_count_;
+  base::subtle::Atomic32 free_count_;
+  base::subtle::Atomic32
+      allocation_size_class_counts_[AsanRuntimeStatistics::kSizeClassCount];
+  base::subtle::Atomic32 quarantine_push_count_;
+  base::subtle::Atomic32 quarantine_pop_count_;
+  base::subtle::Atomic32 quarantine_trim_count_;
+
+  // The number of full stacks captured for each call site, indexed by the
+  // fingerprint of the call site modulo the size of the table. Call sites
+  // sharing a slot share their count, which only makes full captures rarer.
+  static const size_t kCallSiteCountTableSize = 4096;
+  base::subtle::Atomic32 call_site_full_stack_counts_[kCallSiteCountTableSize];
+
  private:
-  // Background thread that takes care of trimming the quarantine
+  // Background threads that take care of trimming the quarantine
   // asynchronously.
   base::Lock deferred_free_thread_lock_;
   // Under deferred_free_thread_lock_.
-  std::unique_ptr<DeferredFreeThread> deferred_free_thread_;
+  std::vector<std::unique_ptr<DeferredFreeThread>> deferred_free_threads_;
 
   DISALLOW_COPY_AND_ASSIGN(BlockHeapManager);
 };
@@ -25,7 +25,9 @@
 #include "base/synchronization/lock.h"
 #include "base/synchronization/waitable_event.h"
 #include "base/test/test_reg_util_win.h"
+#include "base/threading/platform_thread.h"
 #include "base/threading/simple_thread.h"
+#include "base/time/time.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/block.h"
@@ -38,6 +40,7 @@
 #include "syzygy/agent/asan/heaps/internal_heap.h"
 #include "syzygy/agent/asan/heaps/large_block_heap.h"
 #include "syzygy/agent/asan/heaps/simple_block_heap.h"
+#include "syzygy/agent/asan/heaps/slab_block_heap.h"
 #include "syzygy/agent/asan/heaps/win_heap.h"
 #include "syzygy/agent/asan/heaps/zebra_block_heap.h"
 #include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
@@ -52,6 +55,7 @@ namespace heap_managers {
 
 namespace {
 
+using heaps::SlabBlockHeap;
 using heaps::ZebraBlockHeap;
 using testing::IsAccessible;
 using testing::IsNotAccessible;
@@ -216,6 +220,7 @@ class TestBlockHeapManager : public BlockHeapManager {
 
   using BlockHeapManager::FreePotentiallyCorruptBlock;
   using BlockHeapManager::GetCorruptBlockHeapId;
+  using BlockHeapManager::GetDeferredFreeThreadCount;
   using BlockHeapManager::GetHeapId;
   using BlockHeapManager::GetHeapFromId;
   using BlockHeapManager::GetHeapTypeUnlocked;
@@ -225,6 +230,7 @@ class TestBlockHeapManager : public BlockHeapManager {
   using BlockHeapManager::IsValidHeapIdUnlocked;
   using BlockHeapManager::SetHeapErrorCallback;
   using BlockHeapManager::ShardedBlockQuarantine;
+  using BlockHeapManager::SizeClassBlockQuarantine;
   using BlockHeapManager::TrimQuarantine;
 
   using BlockHeapManager::allocation_filter_flag_tls_;
@@ -234,8 +240,12 @@ class TestBlockHeapManager : public BlockHeapManager {
   using BlockHeapManager::large_block_heap_id_;
   using BlockHeapManager::locked_heaps_;
   using BlockHeapManager::parameters_;
+  using BlockHeapManager::per_cpu_quarantine_;
   using BlockHeapManager::shadow_;
   using BlockHeapManager::shared_quarantine_;
+  using BlockHeapManager::size_class_quarantine_;
+  using BlockHeapManager::slab_block_heap_id_;
+  using BlockHeapManager::stack_cache_;
   using BlockHeapManager::zebra_block_heap_;
   using BlockHeapManager::zebra_block_heap_id_;
 
@@ -613,6 +623,72 @@ TEST_F(BlockHeapManagerTest, AllocAndFree) {
   EXPECT_TRUE(heap_manager_->DestroyHeap(heap_id));
 }
 
+TEST_F(BlockHeapManagerTest, PerCpuQuarantine) {
+  // The shared quarantine is chosen at initialization time, so this needs a
+  // heap manager of its own.
+  TestBlockHeapManager heap_manager(runtime_->shadow(),
+                                    runtime_->stack_cache(),
+                                    runtime_->memory_notifier());
+  ::common::AsanParameters params = heap_manager_->parameters();
+  params.enable_per_cpu_quarantine = true;
+  heap_manager.set_parameters(params);
+  heap_manager.Init();
+
+  HeapId heap_id = heap_manager.CreateHeap();
+  EXPECT_NE(0u, heap_id);
+  EXPECT_EQ(static_cast<BlockQuarantineInterface*>(
+                &heap_manager.per_cpu_quarantine_),
+            heap_manager.GetQuarantineFromId(heap_id));
+
+  // Freed blocks end up in the quarantine.
+  const size_t kAllocSize = 17;
+  void* alloc = heap_manager.Allocate(heap_id, kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_TRUE(heap_manager.Free(heap_id, alloc));
+  EXPECT_EQ(1u, heap_manager.per_cpu_quarantine_.GetCountForTesting());
+  EXPECT_EQ(kHeapFreedMarker,
+            runtime_->shadow()->GetShadowMarkerForAddress(alloc));
+
+  EXPECT_TRUE(heap_manager.DestroyHeap(heap_id));
+  EXPECT_EQ(0u, heap_manager.per_cpu_quarantine_.GetCountForTesting());
+}
+
+TEST_F(BlockHeapManagerTest, SizeClassQuarantine) {
+  TestBlockHeapManager heap_manager(runtime_->shadow(),
+                                    runtime_->stack_cache(),
+                                    runtime_->memory_notifier());
+  ::common::AsanParameters params = heap_manager_->parameters();
+  params.enable_size_class_quarantine = true;
+  heap_manager.set_parameters(params);
+  heap_manager.Init();
+
+  HeapId heap_id = heap_manager.CreateHeap();
+  EXPECT_NE(0u, heap_id);
+  EXPECT_EQ(static_cast<BlockQuarantineInterface*>(
+                &heap_manager.size_class_quarantine_),
+            heap_manager.GetQuarantineFromId(heap_id));
+  EXPECT_EQ(params.quarantine_size,
+            heap_manager.size_class_quarantine_.max_quarantine_size());
+
+  // Freed blocks end up in the quarantine, in the size class of the block.
+  const size_t kAllocSize = 17;
+  void* alloc = heap_manager.Allocate(heap_id, kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_TRUE(heap_manager.Free(heap_id, alloc));
+  EXPECT_EQ(1u, heap_manager.size_class_quarantine_.GetCountForTesting());
+  size_t block_size = heap_manager.size_class_quarantine_.GetSizeForTesting();
+  size_t size_class =
+      TestBlockHeapManager::SizeClassBlockQuarantine::GetSizeClass(block_size);
+  EXPECT_EQ(block_size,
+            heap_manager.size_class_quarantine_.GetSizeClassSizeForTesting(
+                size_class));
+  EXPECT_EQ(kHeapFreedMarker,
+            runtime_->shadow()->GetShadowMarkerForAddress(alloc));
+
+  EXPECT_TRUE(heap_manager.DestroyHeap(heap_id));
+  EXPECT_EQ(0u, heap_manager.size_class_quarantine_.GetCountForTesting());
+}
+
 TEST_F(BlockHeapManagerTest, AllocAndFreeLargeBlock) {
   TEST_ONLY_SUPPORTS_4G();
 
@@ -688,6 +764,94 @@ TEST_F(BlockHeapManagerTest, PopOnSetQuarantineMaxSize) {
   ASSERT_FALSE(heap.InQuarantine(mem));
 }
 
+TEST_F(BlockHeapManagerTest, GetStatistics) {
+  const size_t kAllocSize = 100;
+  uint32_t real_alloc_size = GetAllocSize(kAllocSize);
+  ScopedHeap heap(heap_manager_);
+
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = real_alloc_size;
+  heap_manager_->set_parameters(parameters);
+
+  AsanRuntimeStatistics before = {};
+  heap_manager_->GetStatistics(&before);
+
+  // 100 bytes fall in the [64, 128) size class.
+  void* mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  ASSERT_TRUE(heap.Free(mem));
+  ASSERT_TRUE(heap.InQuarantine(mem));
+
+  // Shrinking the quarantine trims it, and pops the block.
+  parameters.quarantine_size = real_alloc_size - 1;
+  heap_manager_->set_parameters(parameters);
+  ASSERT_FALSE(heap.InQuarantine(mem));
+
+  AsanRuntimeStatistics after = {};
+  heap_manager_->GetStatistics(&after);
+  EXPECT_EQ(before.allocations + 1, after.allocations);
+  EXPECT_EQ(before.frees + 1, after.frees);
+  EXPECT_EQ(before.allocation_size_classes[7] + 1,
+            after.allocation_size_classes[7]);
+  EXPECT_EQ(before.quarantine_pushes + 1, after.quarantine_pushes);
+  EXPECT_EQ(before.quarantine_pops + 1, after.quarantine_pops);
+  EXPECT_LT(before.quarantine_trims, after.quarantine_trims);
+
+  // The process heap and the heap created above both keep lock statistics.
+  EXPECT_LE(2u, after.heap_count);
+  EXPECT_GE(AsanRuntimeStatistics::kMaxHeapCount, after.heap_count);
+}
+
+TEST_F(BlockHeapManagerTest, StackCaptureDepthIsCapped) {
+  // Disable page protections so that the header of the freed block can be
+  // read.
+  heap_manager_->enable_page_protections_ = false;
+
+  ScopedHeap heap(heap_manager_);
+  StackCaptureCache* stack_cache = heap_manager_->stack_cache_;
+  size_t old_max_num_frames = stack_cache->max_num_frames();
+  stack_cache->set_max_num_frames(1);
+
+  void* mem = heap.Allocate(32);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+  BlockInfo block_info = {};
+  EXPECT_TRUE(GetBlockInfo(heap_manager_->shadow_,
+                           reinterpret_cast<BlockBody*>(mem), &block_info));
+  EXPECT_GE(1u, block_info.header->alloc_stack->num_frames());
+  ASSERT_TRUE(heap.Free(mem));
+  EXPECT_GE(1u, block_info.header->free_stack->num_frames());
+
+  stack_cache->set_max_num_frames(old_max_num_frames);
+}
+
+TEST_F(BlockHeapManagerTest, SampledFullStackCapture) {
+  ScopedHeap heap(heap_manager_);
+
+  // Only capture the first full stack of each call site.
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.full_stack_capture_rate = 0.0f;
+  parameters.full_stack_captures_per_site = 1;
+  heap_manager_->set_parameters(parameters);
+
+  std::vector<size_t> num_frames;
+  for (size_t i = 0; i < 3; ++i) {
+    void* mem = heap.Allocate(32);
+    ASSERT_NE(static_cast<void*>(nullptr), mem);
+    BlockInfo block_info = {};
+    EXPECT_TRUE(GetBlockInfo(heap_manager_->shadow_,
+                             reinterpret_cast<BlockBody*>(mem), &block_info));
+    ASSERT_TRUE(block_info.header->alloc_stack->IsValid());
+    num_frames.push_back(block_info.header->alloc_stack->num_frames());
+    ASSERT_TRUE(heap.Free(mem));
+  }
+
+  // The first allocation has the full stack, which runs deeper than the
+  // fingerprints of the others. All of them come from the same call site.
+  EXPECT_LT(num_frames[1], num_frames[0]);
+  EXPECT_EQ(num_frames[1], num_frames[2]);
+  EXPECT_GE(4u, num_frames[1]);
+}
+
 TEST_F(BlockHeapManagerTest, Quarantine) {
   const uint32_t kAllocSize = 100;
   uint32_t real_alloc_size = GetAllocSize(kAllocSize);
@@ -863,6 +1027,29 @@ TEST_F(BlockHeapManagerTest, Size) {
   }
 }
 
+TEST_F(BlockHeapManagerTest, ResizeInPlace) {
+  const uint32_t kAllocSize = 100;
+  ScopedHeap heap(heap_manager_);
+  void* mem = heap.Allocate(kAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), mem);
+
+  // Shrinking always fits in the existing block.
+  EXPECT_TRUE(heap_manager_->ResizeInPlace(heap.Id(), mem, kAllocSize / 2));
+  EXPECT_EQ(kAllocSize / 2, heap_manager_->Size(heap.Id(), mem));
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(mem, kAllocSize / 2));
+
+  // Growing back into the slack left by the shrink fits as well.
+  EXPECT_TRUE(heap_manager_->ResizeInPlace(heap.Id(), mem, kAllocSize));
+  EXPECT_EQ(kAllocSize, heap_manager_->Size(heap.Id(), mem));
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(mem, kAllocSize));
+
+  // Growing past the end of the block leaves the allocation untouched.
+  EXPECT_FALSE(heap_manager_->ResizeInPlace(heap.Id(), mem, kAllocSize * 100));
+  EXPECT_EQ(kAllocSize, heap_manager_->Size(heap.Id(), mem));
+
+  ASSERT_TRUE(heap.Free(mem));
+}
+
 TEST_F(BlockHeapManagerTest, AllocsAccessibility) {
   const uint32_t kMaxAllocSize = 134584;
   ScopedHeap heap(heap_manager_);
@@ -1265,6 +1452,67 @@ TEST_F(BlockHeapManagerTest, SubsampledAllocationGuards) {
   EXPECT_GT(6 * kAllocationCount / 10, guarded_allocations);
 }
 
+TEST_F(BlockHeapManagerTest, SampledAllocationGuards) {
+  EnableTestZebraBlockHeap();
+  EnableLargeBlockHeap(1024 * 1024);
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.allocation_guard_rate = 0.25;
+  parameters.enable_sampled_allocation_guards = true;
+  heap_manager_->set_parameters(parameters);
+  ScopedHeap heap(heap_manager_);
+
+  size_t guarded_allocations = 0;
+  const size_t kAllocationCount = 10000;
+  const size_t kAllocationSizes[] = { 1, 8, 30, 237, 2036, 5000 };
+  for (size_t i = 0; i < kAllocationCount; ++i) {
+    uint32_t alloc_size = static_cast<uint32_t>(
+        kAllocationSizes[i % arraysize(kAllocationSizes)]);
+    void* alloc = heap.Allocate(alloc_size);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+
+    BlockInfo block_info = {};
+    if (runtime_->shadow()->BlockInfoFromShadow(alloc, &block_info)) {
+      ++guarded_allocations;
+      ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(alloc, alloc_size));
+
+      // Guarded allocations always land in a page protected slot.
+      ScopedBlockAccess block_access(block_info, runtime_->shadow());
+      if (block_info.trailer->heap_id != heap_manager_->large_block_heap_id_) {
+        EXPECT_EQ(heap_manager_->zebra_block_heap_id_,
+                  block_info.trailer->heap_id);
+      }
+    } else {
+      for (size_t j = 0; j < alloc_size; ++j) {
+        ASSERT_TRUE(runtime_->shadow()->IsAccessible(
+            reinterpret_cast<uint8_t*>(alloc) + j));
+      }
+    }
+
+    EXPECT_TRUE(heap.Free(alloc));
+  }
+  EXPECT_NO_FATAL_FAILURE(heap.FlushQuarantine());
+
+  // The expected number of guarded allocations is 2500, with a standard
+  // deviation of sqrt(10000 * 0.25 * 0.75) ~= 43. A margin of 1000 is over 20
+  // standard deviations.
+  EXPECT_LT(15 * kAllocationCount / 100, guarded_allocations);
+  EXPECT_GT(35 * kAllocationCount / 100, guarded_allocations);
+
+  // Nothing is guarded with a rate of zero, and everything with a rate of one.
+  parameters.allocation_guard_rate = 0.0;
+  heap_manager_->set_parameters(parameters);
+  void* alloc = heap.Allocate(10);
+  BlockInfo block_info = {};
+  EXPECT_FALSE(runtime_->shadow()->BlockInfoFromShadow(alloc, &block_info));
+  EXPECT_TRUE(heap.Free(alloc));
+
+  parameters.allocation_guard_rate = 1.0;
+  heap_manager_->set_parameters(parameters);
+  alloc = heap.Allocate(10);
+  EXPECT_TRUE(runtime_->shadow()->BlockInfoFromShadow(alloc, &block_info));
+  EXPECT_TRUE(heap.Free(alloc));
+}
+
 // Ensures that the ZebraBlockHeap overrides the provided heap.
 TEST_F(BlockHeapManagerTest, ZebraHeapIdInTrailerAfterAllocation) {
   EnableTestZebraBlockHeap();
@@ -1584,6 +1832,42 @@ TEST_F(BlockHeapManagerTest, LargeBlockHeapNotUsedForSmallAllocations) {
   EXPECT_TRUE(heap.Free(alloc));
 }
 
+TEST_F(BlockHeapManagerTest, SlabBlockHeapServesSmallAllocations) {
+  ::common::AsanParameters params = heap_manager_->parameters();
+  params.enable_slab_block_heap = true;
+  heap_manager_->set_parameters(params);
+  ASSERT_NE(0u, heap_manager_->slab_block_heap_id_);
+  ScopedHeap heap(heap_manager_);
+
+  const uint32_t kSmallAllocSize = 0x100;
+  const uint32_t kLargeAllocSize = SlabBlockHeap::kMaximumAllocationSize;
+  void* small_alloc = heap.Allocate(kSmallAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), small_alloc);
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(small_alloc, kSmallAllocSize));
+  void* large_alloc = heap.Allocate(kLargeAllocSize);
+  ASSERT_NE(static_cast<void*>(nullptr), large_alloc);
+  ASSERT_NO_FATAL_FAILURE(VerifyAllocAccess(large_alloc, kLargeAllocSize));
+
+  BlockInfo small_block = {};
+  EXPECT_TRUE(runtime_->shadow()->BlockInfoFromShadow(small_alloc,
+                                                      &small_block));
+  BlockInfo large_block = {};
+  EXPECT_TRUE(runtime_->shadow()->BlockInfoFromShadow(large_alloc,
+                                                      &large_block));
+  {
+    ScopedBlockAccess small_access(small_block, runtime_->shadow());
+    ScopedBlockAccess large_access(large_block, runtime_->shadow());
+    EXPECT_EQ(heap_manager_->slab_block_heap_id_,
+              small_block.trailer->heap_id);
+    // The block of the large allocation doesn't fit in a slot.
+    EXPECT_EQ(heap.Id(), large_block.trailer->heap_id);
+  }
+
+  EXPECT_TRUE(heap.Free(small_alloc));
+  ASSERT_NO_FATAL_FAILURE(VerifyFreedAccess(small_alloc, kSmallAllocSize));
+  EXPECT_TRUE(heap.Free(large_alloc));
+}
+
 TEST_F(BlockHeapManagerTest, AllocationFilterFlag) {
   EXPECT_NE(TLS_OUT_OF_INDEXES, heap_manager_->allocation_filter_flag_tls_);
   heap_manager_->set_allocation_filter_flag(true);
@@ -1749,7 +2033,7 @@ TEST_F(BlockHeapManagerTest, DeferredFreeThreadTest) {
   heap_manager_->set_parameters(parameters);
 
   size_t max_size_yellow =
-      heap_manager_->shared_quarantine_.GetMaxSizeForColorForTesting(YELLOW) /
+      heap_manager_->shared_quarantine_->GetMaxSizeForColorForTesting(YELLOW) /
       real_alloc_size;
 
   ASSERT_EQ(kTargetMaxYellow, max_size_yellow);
@@ -1770,20 +2054,63 @@ TEST_F(BlockHeapManagerTest, DeferredFreeThreadTest) {
     heap.Free(heap_mem);
   }
 
-  size_t current_size = heap_manager_->shared_quarantine_.GetSizeForTesting();
-  ASSERT_EQ(RED,
-            heap_manager_->shared_quarantine_.GetQuarantineColor(current_size));
+  size_t current_size = heap_manager_->shared_quarantine_->GetSizeForTesting();
+  ASSERT_EQ(RED, heap_manager_->shared_quarantine_->GetQuarantineColor(
+                     current_size));
 
   // Signal the callback to execute and for it to finish.
   deferred_free_callback_start.Signal();
   deferred_free_callback_end.Wait();
 
-  current_size = heap_manager_->shared_quarantine_.GetSizeForTesting();
-  EXPECT_EQ(GREEN,
-            heap_manager_->shared_quarantine_.GetQuarantineColor(current_size));
+  current_size = heap_manager_->shared_quarantine_->GetSizeForTesting();
+  EXPECT_EQ(GREEN, heap_manager_->shared_quarantine_->GetQuarantineColor(
+                       current_size));
+
+  heap_manager_->DisableDeferredFreeThread();
+  EXPECT_FALSE(heap_manager_->IsDeferredFreeThreadRunning());
+}
+
+TEST_F(BlockHeapManagerTest, DeferredFreeThreadPoolTest) {
+  const uint32_t kAllocSize = 100;
+  const uint32_t kTargetMaxYellow = 100;
+  const uint32_t kThreadCount = 4;
+  uint32_t real_alloc_size = GetAllocSize(kAllocSize);
+  ScopedHeap heap(heap_manager_);
+
+  ::common::AsanParameters parameters = heap_manager_->parameters();
+  parameters.quarantine_size = real_alloc_size * kTargetMaxYellow;
+  parameters.deferred_free_thread_count = kThreadCount;
+  heap_manager_->set_parameters(parameters);
+
+  heap_manager_->EnableDeferredFreeThread();
+  ASSERT_TRUE(heap_manager_->IsDeferredFreeThreadRunning());
+  EXPECT_EQ(kThreadCount, heap_manager_->GetDeferredFreeThreadCount());
+
+  // Free a lot more blocks than the quarantine can hold. The threads bring the
+  // quarantine back to GREEN, possibly with some help from this thread.
+  for (size_t i = 0; i < 20 * kTargetMaxYellow; ++i) {
+    void* heap_mem = heap.Allocate(kAllocSize);
+    ASSERT_NE(static_cast<void*>(nullptr), heap_mem);
+    heap.Free(heap_mem);
+  }
+
+  base::TimeTicks deadline =
+      base::TimeTicks::Now() + base::TimeDelta::FromSeconds(10);
+  size_t current_size = 0;
+  do {
+    current_size = heap_manager_->shared_quarantine_->GetSizeForTesting();
+    if (heap_manager_->shared_quarantine_->GetQuarantineColor(current_size) ==
+        GREEN) {
+      break;
+    }
+    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(1));
+  } while (base::TimeTicks::Now() < deadline);
+  EXPECT_EQ(GREEN, heap_manager_->shared_quarantine_->GetQuarantineColor(
+                       current_size));
 
   heap_manager_->DisableDeferredFreeThread();
   EXPECT_FALSE(heap_manager_->IsDeferredFreeThreadRunning());
+  EXPECT_EQ(0u, heap_manager_->GetDeferredFreeThreadCount());
 }
 
 namespace {
@@ -0,0 +1,290 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/heap_managers/thread_local_block_cache.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace agent {
+namespace asan {
+namespace heap_managers {
+
+ThreadLocalBlockCache::ThreadLocalBlockCache(HeapInterface* internal_heap)
+    : internal_heap_(internal_heap), thread_caches_(nullptr) {
+  DCHECK_NE(static_cast<HeapInterface*>(nullptr), internal_heap);
+  DCHECK_EQ(kMaxCachedBlockSize, kBlockSizeClasses[kSizeClassCount - 1]);
+  thread_cache_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_cache_tls_);
+}
+
+ThreadLocalBlockCache::~ThreadLocalBlockCache() {
+  base::AutoLock lock(lock_);
+  ThreadCache* thread_cache = thread_caches_;
+  while (thread_cache != nullptr) {
+    ThreadCache* next = thread_cache->next;
+#ifndef NDEBUG
+    for (size_t i = 0; i < kHeapSlotCount; ++i)
+      DCHECK_EQ(static_cast<BlockHeapInterface*>(nullptr),
+                thread_cache->slots[i].heap);
+#endif
+    thread_cache->~ThreadCache();
+    internal_heap_->Free(thread_cache);
+    thread_cache = next;
+  }
+  thread_caches_ = nullptr;
+
+  ::TlsFree(thread_cache_tls_);
+  thread_cache_tls_ = TLS_OUT_OF_INDEXES;
+}
+
+bool ThreadLocalBlockCache::IsCacheableHeap(BlockHeapInterface* heap) {
+  DCHECK_NE(static_cast<BlockHeapInterface*>(nullptr), heap);
+  if (heap->GetHeapType() != kWinHeap)
+    return false;
+  if ((heap->GetHeapFeatures() & HeapInterface::kHeapReportsReservations) != 0)
+    return false;
+  return true;
+}
+
+void* ThreadLocalBlockCache::AllocateBlock(BlockHeapInterface* heap,
+                                           uint32_t size,
+                                           uint32_t min_left_redzone_size,
+                                           uint32_t min_right_redzone_size,
+                                           BlockLayout* layout) {
+  DCHECK(IsCacheableHeap(heap));
+  DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
+
+  if (!BlockPlanLayoutCached(kShadowRatio, kShadowRatio, size,
+                             min_left_redzone_size, min_right_redzone_size,
+                             layout)) {
+    return nullptr;
+  }
+
+  size_t size_class = GetSizeClassForAllocation(layout->block_size);
+  if (size_class == kSizeClassCount)
+    return heap->Allocate(layout->block_size);
+
+  // Grow the right redzone so that the block exactly fills its size class.
+  // This makes cached blocks interchangeable and improves overflow detection.
+  uint32_t extra_size = kBlockSizeClasses[size_class] - layout->block_size;
+  if (extra_size != 0) {
+    if (!BlockPlanLayoutCached(kShadowRatio, kShadowRatio, size,
+                               min_left_redzone_size,
+                               layout->trailer_size +
+                                   layout->trailer_padding_size + extra_size,
+                               layout)) {
+      return nullptr;
+    }
+  }
+  DCHECK_EQ(kBlockSizeClasses[size_class], layout->block_size);
+
+  ThreadCache* thread_cache = GetThreadCache();
+  if (thread_cache == nullptr)
+    return heap->Allocate(layout->block_size);
+
+  base::AutoLock lock(thread_cache->lock);
+  HeapSlot* slot = FindHeapSlot(thread_cache, heap, true);
+  if (slot == nullptr)
+    return heap->Allocate(layout->block_size);
+
+  Magazine* magazine = &slot->magazines[size_class];
+  if (magazine->count == 0)
+    Refill(heap, size_class, magazine);
+  if (magazine->count == 0)
+    return nullptr;
+
+  void* alloc = magazine->blocks[--magazine->count];
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(alloc) % kShadowRatio);
+  return alloc;
+}
+
+bool ThreadLocalBlockCache::FreeBlock(BlockHeapInterface* heap,
+                                      const BlockInfo& block_info) {
+  DCHECK(IsCacheableHeap(heap));
+  DCHECK_NE(static_cast<BlockHeader*>(nullptr), block_info.header);
+
+  size_t size_class = GetSizeClassForFree(block_info.block_size);
+  if (size_class == kSizeClassCount)
+    return heap->FreeBlock(block_info);
+
+  ThreadCache* thread_cache = GetThreadCache();
+  if (thread_cache == nullptr)
+    return heap->FreeBlock(block_info);
+
+  base::AutoLock lock(thread_cache->lock);
+  HeapSlot* slot = FindHeapSlot(thread_cache, heap, true);
+  if (slot == nullptr)
+    return heap->FreeBlock(block_info);
+
+  Magazine* magazine = &slot->magazines[size_class];
+  if (magazine->count == kMagazineCapacity)
+    Drain(heap, kBatchSize, magazine);
+  DCHECK_GT(kMagazineCapacity, magazine->count);
+  magazine->blocks[magazine->count++] = block_info.header;
+  return true;
+}
+
+void ThreadLocalBlockCache::FlushHeap(BlockHeapInterface* heap) {
+  DCHECK_NE(static_cast<BlockHeapInterface*>(nullptr), heap);
+
+  base::AutoLock lock(lock_);
+  for (ThreadCache* thread_cache = thread_caches_; thread_cache != nullptr;
+       thread_cache = thread_cache->next) {
+    base::AutoLock thread_lock(thread_cache->lock);
+    HeapSlot* slot = FindHeapSlot(thread_cache, heap, false);
+    if (slot == nullptr)
+      continue;
+    for (size_t i = 0; i < kSizeClassCount; ++i)
+      Drain(heap, kMagazineCapacity, &slot->magazines[i]);
+    slot->heap = nullptr;
+  }
+}
+
+void ThreadLocalBlockCache::FlushThread() {
+  ThreadCache* thread_cache =
+      reinterpret_cast<ThreadCache*>(::TlsGetValue(thread_cache_tls_));
+  if (thread_cache == nullptr)
+    return;
+
+  {
+    // This takes the locks in the same order as FlushHeap, so that the heaps
+    // can't be flushed and destroyed while being drained here.
+    base::AutoLock lock(lock_);
+    ThreadCache** link = &thread_caches_;
+    while (*link != thread_cache) {
+      DCHECK_NE(static_cast<ThreadCache*>(nullptr), *link);
+      link = &(*link)->next;
+    }
+    *link = thread_cache->next;
+
+    base::AutoLock thread_lock(thread_cache->lock);
+    for (size_t i = 0; i < kHeapSlotCount; ++i) {
+      HeapSlot* slot = &thread_cache->slots[i];
+      if (slot->heap == nullptr)
+        continue;
+      for (size_t j = 0; j < kSizeClassCount; ++j)
+        Drain(slot->heap, kMagazineCapacity, &slot->magazines[j]);
+      slot->heap = nullptr;
+    }
+  }
+
+  ::TlsSetValue(thread_cache_tls_, nullptr);
+  thread_cache->~ThreadCache();
+  internal_heap_->Free(thread_cache);
+}
+
+size_t ThreadLocalBlockCache::GetSizeClassForAllocation(uint32_t block_size) {
+  const uint32_t* size_class = std::lower_bound(
+      kBlockSizeClasses, kBlockSizeClasses + kSizeClassCount, block_size);
+  return size_class - kBlockSizeClasses;
+}
+
+size_t ThreadLocalBlockCache::GetSizeClassForFree(uint32_t block_size) {
+  const uint32_t* size_class = std::upper_bound(
+      kBlockSizeClasses, kBlockSizeClasses + kSizeClassCount, block_size);
+  if (size_class == kBlockSizeClasses)
+    return kSizeClassCount;
+  // Blocks that are bigger than the largest size class aren't cached, as they
+  // would be wasting a lot of memory.
+  if (block_size > kMaxCachedBlockSize)
+    return kSizeClassCount;
+  return size_class - kBlockSizeClasses - 1;
+}
+
+ThreadLocalBlockCache::ThreadCache* ThreadLocalBlockCache::GetThreadCache() {
+  ThreadCache* thread_cache =
+      reinterpret_cast<ThreadCache*>(::TlsGetValue(thread_cache_tls_));
+  if (thread_cache != nullptr)
+    return thread_cache;
+
+  // This is the first time this thread uses the cache. Use a placement new
+  // on memory coming from the internal heap.
+  void* memory = internal_heap_->Allocate(sizeof(ThreadCache));
+  if (memory == nullptr)
+    return nullptr;
+  thread_cache = new (memory) ThreadCache();
+  ::memset(thread_cache->slots, 0, sizeof(thread_cache->slots));
+
+  {
+    base::AutoLock lock(lock_);
+    thread_cache->next = thread_caches_;
+    thread_caches_ = thread_cache;
+  }
+
+  ::TlsSetValue(thread_cache_tls_, thread_cache);
+  return thread_cache;
+}
+
+ThreadLocalBlockCache::HeapSlot* ThreadLocalBlockCache::FindHeapSlot(
+    ThreadCache* thread_cache,
+    BlockHeapInterface* heap,
+    bool claim) {
+  DCHECK_NE(static_cast<ThreadCache*>(nullptr), thread_cache);
+  thread_cache->lock.AssertAcquired();
+
+  HeapSlot* free_slot = nullptr;
+  for (size_t i = 0; i < kHeapSlotCount; ++i) {
+    HeapSlot* slot = &thread_cache->slots[i];
+    if (slot->heap == heap)
+      return slot;
+    if (slot->heap == nullptr && free_slot == nullptr)
+      free_slot = slot;
+  }
+
+  if (!claim || free_slot == nullptr)
+    return nullptr;
+
+  // Free slots always have empty magazines, as they are drained when being
+  // released.
+  free_slot->heap = heap;
+  return free_slot;
+}
+
+void ThreadLocalBlockCache::Refill(BlockHeapInterface* heap,
+                                   size_t size_class,
+                                   Magazine* magazine) {
+  DCHECK_NE(static_cast<Magazine*>(nullptr), magazine);
+  DCHECK_GT(kSizeClassCount, size_class);
+
+  uint32_t block_size = kBlockSizeClasses[size_class];
+  heap->Lock();
+  while (magazine->count < kBatchSize) {
+    void* alloc = heap->Allocate(block_size);
+    if (alloc == nullptr)
+      break;
+    magazine->blocks[magazine->count++] = alloc;
+  }
+  heap->Unlock();
+}
+
+void ThreadLocalBlockCache::Drain(BlockHeapInterface* heap,
+                                  size_t count,
+                                  Magazine* magazine) {
+  DCHECK_NE(static_cast<Magazine*>(nullptr), magazine);
+  if (magazine->count == 0)
+    return;
+
+  heap->Lock();
+  while (count > 0 && magazine->count > 0) {
+    CHECK(heap->Free(magazine->blocks[--magazine->count]));
+    --count;
+  }
+  heap->Unlock();
+}
+
+}  // namespace heap_managers
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,200 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a per-thread cache of raw block allocations. This sits between the
+// BlockHeapManager and the simple block heaps it manages, and amortizes the
+// cost of acquiring the underlying heap lock over batches of allocations.
+
+#ifndef SYZYGY_AGENT_ASAN_HEAP_MANAGERS_THREAD_LOCAL_BLOCK_CACHE_H_
+#define SYZYGY_AGENT_ASAN_HEAP_MANAGERS_THREAD_LOCAL_BLOCK_CACHE_H_
+
+#include <windows.h>
+
+#include "base/synchronization/lock.h"
+#include "syzygy/agent/asan/block.h"
+#include "syzygy/agent/asan/heap.h"
+
+namespace agent {
+namespace asan {
+namespace heap_managers {
+
+// A thread-local cache of raw allocations, bucketed by block size class. Each
+// thread owns a set of magazines (one per size class and per heap). Blocks are
+// served from and returned to the calling thread's magazines without touching
+// the underlying heap. When a magazine runs dry it is refilled with a batch of
+// allocations made under a single acquisition of the heap lock, and when it
+// overflows half of it is drained back to the heap in the same manner.
+//
+// Blocks sitting in a magazine are not live allocations as far as the heap
+// manager is concerned; their shadow memory is left in the same state as it
+// would be after being returned to the underlying heap.
+//
+// Only heaps for which IsCacheableHeap returns true may be used with this
+// cache. All of the cached blocks belonging to a heap must be flushed via
+// FlushHeap prior to that heap being destroyed. Threads should call
+// FlushThread as they exit, otherwise their cached blocks stay pinned until
+// their heaps are flushed.
+class ThreadLocalBlockCache {
+ public:
+  // The number of distinct size classes. The block sizes of each class are
+  // given by kBlockSizeClasses.
+  static const size_t kSizeClassCount = kBlockSizeClassCount;
+
+  // The largest block size that will be served by the cache. Bigger blocks
+  // are passed directly to the heap.
+  static const uint32_t kMaxCachedBlockSize = 4096;
+
+  // The number of blocks that a single magazine can hold.
+  static const size_t kMagazineCapacity = 32;
+
+  // The number of blocks that are moved between the heap and a magazine at
+  // once.
+  static const size_t kBatchSize = kMagazineCapacity / 2;
+
+  // The maximum number of distinct heaps a thread will cache blocks for.
+  // Allocations from any other heap bypass the cache.
+  static const size_t kHeapSlotCount = 4;
+
+  // Constructor.
+  // @param internal_heap The heap to use for the per-thread bookkeeping.
+  explicit ThreadLocalBlockCache(HeapInterface* internal_heap);
+
+  // Destructor. All heaps must have been flushed prior to this.
+  ~ThreadLocalBlockCache();
+
+  // Determines if blocks from a given heap may be cached. Only heaps that
+  // don't report reservations and that allocate blocks with the default
+  // layout are supported.
+  // @param heap The heap to query.
+  // @returns true if the heap is supported by the cache.
+  static bool IsCacheableHeap(BlockHeapInterface* heap);
+
+  // Allocates a block from the calling thread's magazines. Falls back to the
+  // heap directly for blocks that can't be cached. This has the same
+  // semantics as BlockHeapInterface::AllocateBlock, except that the right
+  // redzone may be grown to fill the size class of the block.
+  // @param heap The heap that should serve the allocation.
+  // @param size The size of the body of the allocation.
+  // @param min_left_redzone_size The minimum size of the left redzone.
+  // @param min_right_redzone_size The minimum size of the right redzone.
+  // @param layout The layout structure to be populated.
+  // @returns a pointer to the allocation upon success, otherwise nullptr.
+  void* AllocateBlock(BlockHeapInterface* heap,
+                      uint32_t size,
+                      uint32_t min_left_redzone_size,
+                      uint32_t min_right_redzone_size,
+                      BlockLayout* layout);
+
+  // Returns a block to the calling thread's magazines. Falls back to freeing
+  // the block directly in the heap if it can't be cached.
+  // @param heap The heap that owns the block.
+  // @param block_info The block to be freed.
+  // @returns true on success, false otherwise.
+  bool FreeBlock(BlockHeapInterface* heap, const BlockInfo& block_info);
+
+  // Returns all of the blocks cached by all threads for a given heap.
+  // @param heap The heap to be flushed.
+  void FlushHeap(BlockHeapInterface* heap);
+
+  // Returns all of the blocks cached by the calling thread to their heaps,
+  // and releases the thread's cache. This is meant to be called when the
+  // thread exits; using the cache again afterwards creates a new one.
+  void FlushThread();
+
+  // @returns the index of the smallest size class that can hold a block of
+  //     the given size, or kSizeClassCount if there is none.
+  // @param block_size The size of the block.
+  static size_t GetSizeClassForAllocation(uint32_t block_size);
+
+  // @returns the index of the largest size class whose blocks fit in an
+  //     allocation of the given size, or kSizeClassCount if there is none.
+  // @param block_size The size of the block.
+  static size_t GetSizeClassForFree(uint32_t block_size);
+
+ protected:
+  // A stack of cached allocations of a single size class.
+  struct Magazine {
+    size_t count;
+    void* blocks[kMagazineCapacity];
+  };
+
+  // The magazines associated with a single heap.
+  struct HeapSlot {
+    BlockHeapInterface* heap;
+    Magazine magazines[kSizeClassCount];
+  };
+
+  // The per-thread state. These are chained into a list so that they can
+  // be flushed from other threads.
+  struct ThreadCache {
+    // Protects the slots. This is only ever contended when a heap is being
+    // flushed.
+    base::Lock lock;
+    HeapSlot slots[kHeapSlotCount];
+    ThreadCache* next;
+  };
+
+  // @returns the cache associated with the calling thread, creating it if
+  //     necessary. Returns nullptr if the cache can't be created.
+  ThreadCache* GetThreadCache();
+
+  // Finds or claims the slot associated with a heap in a thread cache.
+  // @param thread_cache The thread cache to search.
+  // @param heap The heap to look for.
+  // @param claim If true then a free slot will be claimed if none matches.
+  // @returns the slot associated with @p heap, nullptr if there is none.
+  // @note Must be called under thread_cache->lock.
+  static HeapSlot* FindHeapSlot(ThreadCache* thread_cache,
+                                BlockHeapInterface* heap,
+                                bool claim);
+
+  // Refills a magazine with a batch of allocations. The heap lock is taken
+  // once for the whole batch.
+  // @param heap The heap to allocate from.
+  // @param size_class The size class of the magazine.
+  // @param magazine The magazine to refill.
+  static void Refill(BlockHeapInterface* heap,
+                     size_t size_class,
+                     Magazine* magazine);
+
+  // Drains up to @p count blocks from a magazine back to the heap. The heap
+  // lock is taken once for the whole batch.
+  // @param heap The heap the blocks belong to.
+  // @param count The number of blocks to drain.
+  // @param magazine The magazine to drain.
+  static void Drain(BlockHeapInterface* heap,
+                    size_t count,
+                    Magazine* magazine);
+
+  // The heap used to allocate the thread caches.
+  HeapInterface* internal_heap_;
+
+  // The TLS slot holding the calling thread's cache.
+  DWORD thread_cache_tls_;
+
+  // Protects the list of thread caches.
+  base::Lock lock_;
+
+  // The list of all thread caches. Under lock_.
+  ThreadCache* thread_caches_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ThreadLocalBlockCache);
+};
+
+}  // namespace heap_managers
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_HEAP_MANAGERS_THREAD_LOCAL_BLOCK_CACHE_H_
@@ -0,0 +1,302 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/heap_managers/thread_local_block_cache.h"
+
+#include <set>
+
+#include "base/atomicops.h"
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/heaps/simple_block_heap.h"
+#include "syzygy/agent/asan/heaps/win_heap.h"
+#include "syzygy/agent/asan/heaps/zebra_block_heap.h"
+#include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
+
+namespace agent {
+namespace asan {
+namespace heap_managers {
+
+namespace {
+
+class TestThreadLocalBlockCache : public ThreadLocalBlockCache {
+ public:
+  using ThreadLocalBlockCache::GetThreadCache;
+  using ThreadLocalBlockCache::FindHeapSlot;
+  using ThreadLocalBlockCache::HeapSlot;
+  using ThreadLocalBlockCache::ThreadCache;
+  using ThreadLocalBlockCache::thread_caches_;
+
+  explicit TestThreadLocalBlockCache(HeapInterface* internal_heap)
+      : ThreadLocalBlockCache(internal_heap) {
+  }
+
+  // Returns the number of blocks cached by the calling thread for a given
+  // heap and size class.
+  size_t CachedBlockCount(BlockHeapInterface* heap, size_t size_class) {
+    ThreadCache* thread_cache = GetThreadCache();
+    base::AutoLock lock(thread_cache->lock);
+    HeapSlot* slot = FindHeapSlot(thread_cache, heap, false);
+    if (slot == nullptr)
+      return 0;
+    return slot->magazines[size_class].count;
+  }
+};
+
+// A heap that keeps track of the number of live allocations.
+class CountingHeap : public heaps::WinHeap {
+ public:
+  CountingHeap() : live_count_(0) {
+  }
+
+  void* Allocate(uint32_t bytes) override {
+    void* alloc = WinHeap::Allocate(bytes);
+    if (alloc != nullptr)
+      base::subtle::NoBarrier_AtomicIncrement(&live_count_, 1);
+    return alloc;
+  }
+
+  bool Free(void* alloc) override {
+    if (!WinHeap::Free(alloc))
+      return false;
+    base::subtle::NoBarrier_AtomicIncrement(&live_count_, -1);
+    return true;
+  }
+
+  base::subtle::Atomic32 live_count() const {
+    return base::subtle::NoBarrier_Load(&live_count_);
+  }
+
+ private:
+  base::subtle::Atomic32 live_count_;
+};
+
+class ThreadLocalBlockCacheTest : public testing::Test {
+ public:
+  ThreadLocalBlockCacheTest()
+      : heap_(&win_heap_), cache_(&internal_heap_) {
+  }
+
+  void TearDown() override {
+    cache_.FlushHeap(&heap_);
+  }
+
+  heaps::WinHeap internal_heap_;
+  CountingHeap win_heap_;
+  heaps::SimpleBlockHeap heap_;
+  TestThreadLocalBlockCache cache_;
+};
+
+}  // namespace
+
+TEST_F(ThreadLocalBlockCacheTest, SizeClasses) {
+  for (size_t i = 1; i < ThreadLocalBlockCache::kSizeClassCount; ++i) {
+    EXPECT_LT(kBlockSizeClasses[i - 1], kBlockSizeClasses[i]);
+    EXPECT_EQ(0u, kBlockSizeClasses[i] % kShadowRatio);
+  }
+
+  EXPECT_EQ(0u, ThreadLocalBlockCache::GetSizeClassForAllocation(1));
+  EXPECT_EQ(0u, ThreadLocalBlockCache::GetSizeClassForAllocation(16));
+  EXPECT_EQ(1u, ThreadLocalBlockCache::GetSizeClassForAllocation(17));
+  EXPECT_EQ(ThreadLocalBlockCache::kSizeClassCount - 1,
+            ThreadLocalBlockCache::GetSizeClassForAllocation(
+                ThreadLocalBlockCache::kMaxCachedBlockSize));
+  EXPECT_EQ(ThreadLocalBlockCache::kSizeClassCount,
+            ThreadLocalBlockCache::GetSizeClassForAllocation(
+                ThreadLocalBlockCache::kMaxCachedBlockSize + 1));
+
+  EXPECT_EQ(ThreadLocalBlockCache::kSizeClassCount,
+            ThreadLocalBlockCache::GetSizeClassForFree(8));
+  EXPECT_EQ(0u, ThreadLocalBlockCache::GetSizeClassForFree(16));
+  EXPECT_EQ(0u, ThreadLocalBlockCache::GetSizeClassForFree(23));
+  EXPECT_EQ(1u, ThreadLocalBlockCache::GetSizeClassForFree(24));
+  EXPECT_EQ(ThreadLocalBlockCache::kSizeClassCount - 1,
+            ThreadLocalBlockCache::GetSizeClassForFree(
+                ThreadLocalBlockCache::kMaxCachedBlockSize));
+  EXPECT_EQ(ThreadLocalBlockCache::kSizeClassCount,
+            ThreadLocalBlockCache::GetSizeClassForFree(
+                ThreadLocalBlockCache::kMaxCachedBlockSize + 1));
+}
+
+TEST_F(ThreadLocalBlockCacheTest, IsCacheableHeap) {
+  EXPECT_TRUE(ThreadLocalBlockCache::IsCacheableHeap(&heap_));
+
+  memory_notifiers::NullMemoryNotifier notifier;
+  heaps::ZebraBlockHeap zebra_heap(1024 * 1024, &notifier, &internal_heap_);
+  EXPECT_FALSE(ThreadLocalBlockCache::IsCacheableHeap(&zebra_heap));
+}
+
+TEST_F(ThreadLocalBlockCacheTest, AllocationsFillTheirSizeClass) {
+  for (uint32_t size = 0; size < 2 * 1024; size += 7) {
+    BlockLayout layout = {};
+    void* alloc = cache_.AllocateBlock(&heap_, size, 0, sizeof(BlockTrailer),
+                                       &layout);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    EXPECT_EQ(size, layout.body_size);
+    EXPECT_LE(sizeof(BlockTrailer),
+              layout.trailer_size + layout.trailer_padding_size);
+
+    size_t size_class =
+        ThreadLocalBlockCache::GetSizeClassForAllocation(layout.block_size);
+    ASSERT_GT(ThreadLocalBlockCache::kSizeClassCount, size_class);
+    EXPECT_EQ(kBlockSizeClasses[size_class], layout.block_size);
+
+    BlockInfo block = {};
+    BlockInitialize(layout, alloc, &block);
+    EXPECT_TRUE(cache_.FreeBlock(&heap_, block));
+  }
+}
+
+TEST_F(ThreadLocalBlockCacheTest, LargeAllocationsBypassCache) {
+  BlockLayout layout = {};
+  void* alloc = cache_.AllocateBlock(
+      &heap_, 2 * ThreadLocalBlockCache::kMaxCachedBlockSize, 0,
+      sizeof(BlockTrailer), &layout);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+
+  BlockInfo block = {};
+  BlockInitialize(layout, alloc, &block);
+  EXPECT_TRUE(cache_.FreeBlock(&heap_, block));
+
+  for (size_t i = 0; i < ThreadLocalBlockCache::kSizeClassCount; ++i)
+    EXPECT_EQ(0u, cache_.CachedBlockCount(&heap_, i));
+}
+
+TEST_F(ThreadLocalBlockCacheTest, RefillAndDrainInBatches) {
+  static const uint32_t kBodySize = 100;
+
+  // The first allocation refills the magazine with a whole batch.
+  BlockLayout layout = {};
+  void* alloc = cache_.AllocateBlock(&heap_, kBodySize, 0,
+                                     sizeof(BlockTrailer), &layout);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  size_t size_class =
+      ThreadLocalBlockCache::GetSizeClassForAllocation(layout.block_size);
+  EXPECT_EQ(ThreadLocalBlockCache::kBatchSize - 1,
+            cache_.CachedBlockCount(&heap_, size_class));
+
+  // Freed blocks are reused in LIFO order.
+  BlockInfo block = {};
+  BlockInitialize(layout, alloc, &block);
+  EXPECT_TRUE(cache_.FreeBlock(&heap_, block));
+  EXPECT_EQ(ThreadLocalBlockCache::kBatchSize,
+            cache_.CachedBlockCount(&heap_, size_class));
+  void* alloc2 = cache_.AllocateBlock(&heap_, kBodySize, 0,
+                                      sizeof(BlockTrailer), &layout);
+  EXPECT_EQ(alloc, alloc2);
+
+  // Allocate a lot more blocks than fit in a magazine, and free them all.
+  std::set<void*> allocs;
+  allocs.insert(alloc2);
+  while (allocs.size() < 4 * ThreadLocalBlockCache::kMagazineCapacity) {
+    void* alloc = cache_.AllocateBlock(&heap_, kBodySize, 0,
+                                       sizeof(BlockTrailer), &layout);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    EXPECT_TRUE(allocs.insert(alloc).second);
+    EXPECT_GT(ThreadLocalBlockCache::kMagazineCapacity,
+              cache_.CachedBlockCount(&heap_, size_class));
+  }
+  for (void* alloc : allocs) {
+    BlockInitialize(layout, alloc, &block);
+    EXPECT_TRUE(cache_.FreeBlock(&heap_, block));
+    EXPECT_GE(ThreadLocalBlockCache::kMagazineCapacity,
+              cache_.CachedBlockCount(&heap_, size_class));
+  }
+
+  // Flushing empties the magazines.
+  cache_.FlushHeap(&heap_);
+  EXPECT_EQ(0u, cache_.CachedBlockCount(&heap_, size_class));
+}
+
+namespace {
+
+// Allocates and frees a bunch of blocks through a cache.
+class AllocatingThread : public base::SimpleThread {
+ public:
+  AllocatingThread(ThreadLocalBlockCache* cache,
+                   BlockHeapInterface* heap,
+                   bool flush_on_exit)
+      : base::SimpleThread("AllocatingThread"),
+        cache_(cache),
+        heap_(heap),
+        flush_on_exit_(flush_on_exit) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < 1000; ++i) {
+      BlockLayout layout = {};
+      uint32_t size = static_cast<uint32_t>(i % 300);
+      void* alloc = cache_->AllocateBlock(heap_, size, 0,
+                                          sizeof(BlockTrailer), &layout);
+      ASSERT_NE(static_cast<void*>(nullptr), alloc);
+      BlockInfo block = {};
+      BlockInitialize(layout, alloc, &block);
+      ASSERT_TRUE(cache_->FreeBlock(heap_, block));
+    }
+    if (flush_on_exit_)
+      cache_->FlushThread();
+  }
+
+ private:
+  ThreadLocalBlockCache* cache_;
+  BlockHeapInterface* heap_;
+  bool flush_on_exit_;
+};
+
+}  // namespace
+
+TEST_F(ThreadLocalBlockCacheTest, MultipleThreads) {
+  AllocatingThread thread1(&cache_, &heap_, false);
+  AllocatingThread thread2(&cache_, &heap_, false);
+  thread1.Start();
+  thread2.Start();
+  thread1.Join();
+  thread2.Join();
+  EXPECT_LT(0, win_heap_.live_count());
+
+  // The caches of the dead threads can still be flushed.
+  cache_.FlushHeap(&heap_);
+  EXPECT_EQ(0, win_heap_.live_count());
+}
+
+TEST_F(ThreadLocalBlockCacheTest, FlushThread) {
+  AllocatingThread thread1(&cache_, &heap_, true);
+  AllocatingThread thread2(&cache_, &heap_, true);
+  thread1.Start();
+  thread2.Start();
+  thread1.Join();
+  thread2.Join();
+
+  // The exiting threads returned their blocks and released their caches.
+  EXPECT_EQ(0, win_heap_.live_count());
+  EXPECT_EQ(static_cast<TestThreadLocalBlockCache::ThreadCache*>(nullptr),
+            cache_.thread_caches_);
+
+  // The cache is recreated if the thread uses it again.
+  BlockLayout layout = {};
+  void* alloc = cache_.AllocateBlock(&heap_, 10, 0, sizeof(BlockTrailer),
+                                     &layout);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_NE(static_cast<TestThreadLocalBlockCache::ThreadCache*>(nullptr),
+            cache_.thread_caches_);
+  BlockInfo block = {};
+  BlockInitialize(layout, alloc, &block);
+  EXPECT_TRUE(cache_.FreeBlock(&heap_, block));
+  cache_.FlushThread();
+  EXPECT_EQ(0, win_heap_.live_count());
+}
+
+}  // namespace heap_managers
+}  // namespace asan
+}  // namespace agent
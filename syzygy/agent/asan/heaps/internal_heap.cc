@@ -118,6 +118,11 @@ bool InternalHeap::TryLock() {
   return heap_->TryLock();
 }
 
+bool InternalHeap::GetLockStatistics(
+    ::common::RecursiveLock::Statistics* statistics) {
+  return heap_->GetLockStatistics(statistics);
+}
+
 }  // namespace heaps
 }  // namespace asan
 }  // namespace agent
@@ -57,6 +57,8 @@ class InternalHeap : public HeapInterface {
   virtual void Lock();
   virtual void Unlock();
   virtual bool TryLock();
+  virtual bool GetLockStatistics(
+      ::common::RecursiveLock::Statistics* statistics);
   // @}
 
  protected:
@@ -27,9 +27,15 @@ namespace agent {
 namespace asan {
 namespace heaps {
 
+const size_t LargeBlockHeap::kDefaultMaxCacheSize = 16 * 1024 * 1024;
+
 LargeBlockHeap::LargeBlockHeap(MemoryNotifierInterface* memory_notifier,
                                HeapInterface* internal_heap)
     : allocs_(HeapAllocator<void*>(internal_heap)),
+      cache_(std::less<size_t>(),
+             HeapAllocator<std::pair<const size_t, void*>>(internal_heap)),
+      cache_size_(0),
+      max_cache_size_(kDefaultMaxCacheSize),
       memory_notifier_(memory_notifier) {
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
 }
@@ -42,8 +48,10 @@ LargeBlockHeap::~LargeBlockHeap() {
   // it means that there's a memory leak), but it's not always the case in
   // Chrome so we need to release all the resources that we've acquired.
   FreeAllAllocations();
+  FlushCache();
 
   CHECK(allocs_.empty());
+  CHECK(cache_.empty());
 }
 
 HeapType LargeBlockHeap::GetHeapType() const {
@@ -62,7 +70,17 @@ void* LargeBlockHeap::Allocate(uint32_t bytes) {
 
   // TODO(chrisha): Make this allocate with the OS allocation granularity.
   size = ::common::AlignUp(size, GetPageSize());
-  void* alloc = ::VirtualAlloc(nullptr, size, MEM_COMMIT, PAGE_READWRITE);
+  void* alloc = TakeCachedRegion(size);
+  if (alloc == nullptr) {
+    alloc = ::VirtualAlloc(nullptr, size, MEM_COMMIT, PAGE_READWRITE);
+
+    // Give the cached regions back to the OS and try again if we're running
+    // out of memory.
+    if (alloc == nullptr && cache_size() != 0) {
+      FlushCache();
+      alloc = ::VirtualAlloc(nullptr, size, MEM_COMMIT, PAGE_READWRITE);
+    }
+  }
   Allocation allocation = { alloc, bytes };
 
   if (alloc != nullptr) {
@@ -92,6 +110,11 @@ bool LargeBlockHeap::Free(void* alloc) {
     allocs_.erase(it);
   }
 
+  size_t region_size =
+      ::common::AlignUp(std::max<size_t>(size, 1u), GetPageSize());
+  if (CacheRegion(alloc, region_size))
+    return true;
+
   // Notify the OS that this memory has been returned.
   memory_notifier_->NotifyReturnedToOS(alloc, size);
   ::VirtualFree(alloc, 0, MEM_RELEASE);
@@ -123,6 +146,17 @@ uint32_t LargeBlockHeap::GetAllocationSize(const void* alloc) {
   }
 }
 
+void LargeBlockHeap::set_max_cache_size(size_t max_cache_size) {
+  ::common::AutoRecursiveLock lock(lock_);
+  max_cache_size_ = max_cache_size;
+  TrimCache(max_cache_size_);
+}
+
+void LargeBlockHeap::FlushCache() {
+  ::common::AutoRecursiveLock lock(lock_);
+  TrimCache(0);
+}
+
 void LargeBlockHeap::Lock() {
   lock_.Acquire();
 }
@@ -135,6 +169,12 @@ bool LargeBlockHeap::TryLock() {
   return lock_.Try();
 }
 
+bool LargeBlockHeap::GetLockStatistics(
+    ::common::RecursiveLock::Statistics* statistics) {
+  lock_.GetStatistics(statistics);
+  return true;
+}
+
 void* LargeBlockHeap::AllocateBlock(uint32_t size,
                                     uint32_t min_left_redzone_size,
                                     uint32_t min_right_redzone_size,
@@ -143,8 +183,8 @@ void* LargeBlockHeap::AllocateBlock(uint32_t size,
 
   // Plan the layout with full guard pages.
   const uint32_t kPageSize = static_cast<uint32_t>(GetPageSize());
-  if (!BlockPlanLayout(kPageSize, kPageSize, size, kPageSize, kPageSize,
-                       layout)) {
+  if (!BlockPlanLayoutCached(kPageSize, kPageSize, size, kPageSize, kPageSize,
+                             layout)) {
     return nullptr;
   }
   DCHECK_EQ(0u, layout->block_size % kPageSize);
@@ -166,6 +206,62 @@ void LargeBlockHeap::FreeAllAllocations() {
     CHECK(Free(const_cast<void*>(alloc.address)));
 }
 
+void* LargeBlockHeap::TakeCachedRegion(size_t size) {
+  DCHECK_EQ(0u, size % GetPageSize());
+
+  void* alloc = nullptr;
+  {
+    ::common::AutoRecursiveLock lock(lock_);
+    RegionCache::iterator it = cache_.find(size / GetPageSize());
+    if (it == cache_.end())
+      return nullptr;
+    alloc = it->second;
+    cache_.erase(it);
+    cache_size_ -= size;
+  }
+
+  // Restore the protection of the whole region at once. The shadow memory of
+  // the region is reset by the caller.
+  DWORD old_protection = 0;
+  CHECK_NE(FALSE, ::VirtualProtect(alloc, size, PAGE_READWRITE,
+                                   &old_protection));
+  return alloc;
+}
+
+bool LargeBlockHeap::CacheRegion(void* alloc, size_t size) {
+  DCHECK_NE(static_cast<void*>(nullptr), alloc);
+  DCHECK_EQ(0u, size % GetPageSize());
+
+  ::common::AutoRecursiveLock lock(lock_);
+  if (size > max_cache_size_)
+    return false;
+
+  // Make the region inaccessible while it sits in the cache, so that uses
+  // after free still fault.
+  DWORD old_protection = 0;
+  if (!::VirtualProtect(alloc, size, PAGE_NOACCESS, &old_protection))
+    return false;
+
+  TrimCache(max_cache_size_ - size);
+  cache_.insert(std::make_pair(size / GetPageSize(), alloc));
+  cache_size_ += size;
+  return true;
+}
+
+void LargeBlockHeap::TrimCache(size_t max_size) {
+  // The smallest regions are released first, as they are the cheapest to
+  // allocate again.
+  while (cache_size_ > max_size) {
+    DCHECK(!cache_.empty());
+    RegionCache::iterator it = cache_.begin();
+    size_t size = it->first * GetPageSize();
+    memory_notifier_->NotifyReturnedToOS(it->second, size);
+    ::VirtualFree(it->second, 0, MEM_RELEASE);
+    cache_size_ -= size;
+    cache_.erase(it);
+  }
+}
+
 }  // namespace heaps
 }  // namespace asan
 }  // namespace agent
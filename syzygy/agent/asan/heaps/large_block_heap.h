@@ -23,10 +23,17 @@
 // then allocations being fed into the large block heap should be at least
 // 32KB in size. Ideally the large allocation heap should not be leaned on too
 // heavily as it can cause significant memory fragmentation.
+//
+// Freed regions are kept in a bounded cache, grouped by their page count, so
+// that workloads repeatedly allocating and freeing buffers of the same size
+// don't pay for a VirtualAlloc/VirtualFree pair each time. Cached regions are
+// made inaccessible until they are reused.
 
 #ifndef SYZYGY_AGENT_ASAN_HEAPS_LARGE_BLOCK_HEAP_H_
 #define SYZYGY_AGENT_ASAN_HEAPS_LARGE_BLOCK_HEAP_H_
 
+#include <functional>
+#include <map>
 #include <unordered_set>
 
 #include "syzygy/agent/asan/allocators.h"
@@ -42,6 +49,10 @@ namespace heaps {
 
 class LargeBlockHeap : public BlockHeapInterface {
  public:
+  // The default maximum amount of memory held by the cache of freed regions,
+  // in bytes.
+  static const size_t kDefaultMaxCacheSize;
+
   // Constructor.
   // @param memory_notifier The memory notifier to use.
   // @param internal_heap The heap to use for making internal allocations.
@@ -62,6 +73,8 @@ class LargeBlockHeap : public BlockHeapInterface {
   virtual void Lock();
   virtual void Unlock();
   virtual bool TryLock();
+  virtual bool GetLockStatistics(
+      ::common::RecursiveLock::Statistics* statistics);
   // @}
 
   // @name BlockHeapInterface implementation.
@@ -76,6 +89,23 @@ class LargeBlockHeap : public BlockHeapInterface {
   // @returns the number of active allocations in this heap.
   size_t size() const { return allocs_.size(); }
 
+  // @returns the amount of memory held by the cache of freed regions, in
+  //     bytes.
+  size_t cache_size() const { return cache_size_; }
+
+  // @returns the maximum amount of memory held by the cache of freed regions,
+  //     in bytes.
+  size_t max_cache_size() const { return max_cache_size_; }
+
+  // Sets the maximum amount of memory held by the cache of freed regions. The
+  // cache is trimmed right away if needed. A value of zero disables it.
+  // @param max_cache_size The maximum size of the cache, in bytes.
+  void set_max_cache_size(size_t max_cache_size);
+
+  // Returns all the regions held by the cache to the OS. This is also done
+  // when the heap fails to allocate memory.
+  void FlushCache();
+
  protected:
   // Information about an allocation made by this allocator.
   struct Allocation {
@@ -110,9 +140,43 @@ class LargeBlockHeap : public BlockHeapInterface {
       HeapAllocator<Allocation>> AllocationSet;
   AllocationSet allocs_;  // Under lock_.
 
+  // The cache of freed regions, keyed by their page count. The regions of the
+  // cache are committed and PAGE_NOACCESS.
+  typedef std::multimap<
+      size_t,
+      void*,
+      std::less<size_t>,
+      HeapAllocator<std::pair<const size_t, void*>>> RegionCache;
+  RegionCache cache_;  // Under lock_.
+
+  // The amount of memory held by the cache, in bytes. Under lock_.
+  size_t cache_size_;
+
+  // The maximum amount of memory held by the cache, in bytes. Under lock_.
+  size_t max_cache_size_;
+
   // Free all the allocations owned by this heap.
   void FreeAllAllocations();
 
+  // Takes a region out of the cache, and makes it accessible again.
+  // @param size The size of the region, in bytes. This must be a multiple of
+  //     the page size.
+  // @returns a region of @p size bytes, or nullptr if there's none in the
+  //     cache.
+  void* TakeCachedRegion(size_t size);
+
+  // Puts a freed region in the cache, making room for it if necessary.
+  // @param alloc The address of the region.
+  // @param size The size of the region, in bytes.
+  // @returns true if the region has been cached, false if it should be
+  //     returned to the OS.
+  bool CacheRegion(void* alloc, size_t size);
+
+  // Returns cached regions to the OS, smallest first, until the cache holds at
+  // most @p max_size bytes. Under lock_.
+  // @param max_size The maximum size of the cache once trimmed, in bytes.
+  void TrimCache(size_t max_size);
+
   // The global lock for this allocator.
   ::common::RecursiveLock lock_;
 
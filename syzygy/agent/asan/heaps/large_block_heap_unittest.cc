@@ -179,6 +179,67 @@ TEST(LargeBlockHeapTest, DestructionWithOutstandingAllocationsSucceeds) {
   EXPECT_EQ(kAllocCount, h.size());
 }
 
+TEST(LargeBlockHeapTest, FreedRegionsAreReused) {
+  TestLargeBlockHeap h;
+  EXPECT_EQ(LargeBlockHeap::kDefaultMaxCacheSize, h.max_cache_size());
+  EXPECT_EQ(0u, h.cache_size());
+
+  const uint32_t kAllocSize = static_cast<uint32_t>(3 * GetPageSize() + 1);
+  void* a1 = h.Allocate(kAllocSize);
+  ASSERT_TRUE(a1 != NULL);
+  EXPECT_TRUE(h.Free(a1));
+  EXPECT_FALSE(h.IsAllocated(a1));
+  EXPECT_EQ(4 * GetPageSize(), h.cache_size());
+
+  // An allocation with the same number of pages reuses the cached region,
+  // which is accessible again.
+  void* a2 = h.Allocate(kAllocSize + 10);
+  EXPECT_EQ(a1, a2);
+  EXPECT_EQ(0u, h.cache_size());
+  EXPECT_TRUE(h.IsAllocated(a2));
+  ::memset(a2, 0xAB, kAllocSize + 10);
+
+  // An allocation with a different number of pages doesn't.
+  EXPECT_TRUE(h.Free(a2));
+  void* a3 = h.Allocate(static_cast<uint32_t>(GetPageSize()));
+  ASSERT_TRUE(a3 != NULL);
+  EXPECT_NE(a2, a3);
+  EXPECT_EQ(4 * GetPageSize(), h.cache_size());
+
+  EXPECT_TRUE(h.Free(a3));
+  EXPECT_EQ(5 * GetPageSize(), h.cache_size());
+  h.FlushCache();
+  EXPECT_EQ(0u, h.cache_size());
+}
+
+TEST(LargeBlockHeapTest, CacheSizeIsBounded) {
+  TestLargeBlockHeap h;
+  h.set_max_cache_size(4 * GetPageSize());
+
+  void* a1 = h.Allocate(static_cast<uint32_t>(GetPageSize()));
+  void* a2 = h.Allocate(static_cast<uint32_t>(3 * GetPageSize()));
+  void* a3 = h.Allocate(static_cast<uint32_t>(2 * GetPageSize()));
+  void* a4 = h.Allocate(static_cast<uint32_t>(5 * GetPageSize()));
+  EXPECT_TRUE(h.Free(a1));
+  EXPECT_TRUE(h.Free(a2));
+  EXPECT_EQ(4 * GetPageSize(), h.cache_size());
+
+  // Making room for this region evicts the cached regions, smallest first.
+  EXPECT_TRUE(h.Free(a3));
+  EXPECT_EQ(2 * GetPageSize(), h.cache_size());
+
+  // Regions bigger than the cache aren't cached.
+  EXPECT_TRUE(h.Free(a4));
+  EXPECT_EQ(2 * GetPageSize(), h.cache_size());
+
+  // Shrinking the cache trims it.
+  h.set_max_cache_size(0);
+  EXPECT_EQ(0u, h.cache_size());
+  void* a5 = h.Allocate(static_cast<uint32_t>(GetPageSize()));
+  EXPECT_TRUE(h.Free(a5));
+  EXPECT_EQ(0u, h.cache_size());
+}
+
 }  // namespace heaps
 }  // namespace asan
 }  // namespace agent
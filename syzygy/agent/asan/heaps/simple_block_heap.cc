@@ -63,6 +63,11 @@ bool SimpleBlockHeap::TryLock() {
   return heap_->TryLock();
 }
 
+bool SimpleBlockHeap::GetLockStatistics(
+    ::common::RecursiveLock::Statistics* statistics) {
+  return heap_->GetLockStatistics(statistics);
+}
+
 void* SimpleBlockHeap::AllocateBlock(uint32_t size,
                                      uint32_t min_left_redzone_size,
                                      uint32_t min_right_redzone_size,
@@ -70,8 +75,9 @@ void* SimpleBlockHeap::AllocateBlock(uint32_t size,
   DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
 
   // Plan the block layout.
-  if (!BlockPlanLayout(kShadowRatio, kShadowRatio, size, min_left_redzone_size,
-                       min_right_redzone_size, layout)) {
+  if (!BlockPlanLayoutCached(kShadowRatio, kShadowRatio, size,
+                             min_left_redzone_size, min_right_redzone_size,
+                             layout)) {
     return nullptr;
   }
 
@@ -46,6 +46,8 @@ class SimpleBlockHeap : public BlockHeapInterface {
   virtual void Lock();
   virtual void Unlock();
   virtual bool TryLock();
+  virtual bool GetLockStatistics(
+      ::common::RecursiveLock::Statistics* statistics);
   // @}
 
   // @name BlockHeapInterface implementation.
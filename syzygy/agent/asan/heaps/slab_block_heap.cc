@@ -0,0 +1,393 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/heaps/slab_block_heap.h"
+
+#include <algorithm>
+
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+namespace heaps {
+
+SlabBlockHeap::SlabBlockHeap(MemoryNotifierInterface* memory_notifier,
+                             HeapInterface* internal_heap)
+    : slabs_(nullptr),
+      slab_count_(0),
+      internal_heap_(internal_heap),
+      memory_notifier_(memory_notifier),
+      thread_states_(nullptr) {
+  DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
+  DCHECK_NE(static_cast<HeapInterface*>(nullptr), internal_heap);
+  static_assert(sizeof(SlabHeader) <= kSlabHeaderSize,
+                "The slab header doesn't fit in kSlabHeaderSize.");
+  DCHECK_EQ(kMaximumAllocationSize, kBlockSizeClasses[kSizeClassCount - 1]);
+  ::memset(partial_slabs_, 0, sizeof(partial_slabs_));
+  thread_state_tls_ = ::TlsAlloc();
+  CHECK_NE(TLS_OUT_OF_INDEXES, thread_state_tls_);
+}
+
+SlabBlockHeap::~SlabBlockHeap() {
+  // No need to lock here, as concurrent access to an object under destruction
+  // is a programming error.
+  while (slabs_ != nullptr) {
+    if (slabs_->is_partial)
+      RemovePartialSlab(slabs_);
+    ReleaseSlab(slabs_);
+  }
+  DCHECK_EQ(0u, slab_count_);
+
+  while (thread_states_ != nullptr) {
+    ThreadState* next = thread_states_->next;
+    internal_heap_->Free(thread_states_);
+    thread_states_ = next;
+  }
+
+  ::TlsFree(thread_state_tls_);
+  thread_state_tls_ = TLS_OUT_OF_INDEXES;
+}
+
+HeapType SlabBlockHeap::GetHeapType() const {
+  return kSlabBlockHeap;
+}
+
+uint32_t SlabBlockHeap::GetHeapFeatures() const {
+  return kHeapReportsReservations | kHeapSupportsGetAllocationSize |
+      kHeapGetAllocationSizeIsUpperBound;
+}
+
+void* SlabBlockHeap::Allocate(uint32_t bytes) {
+  size_t size_class = GetSizeClass(bytes);
+  if (size_class == kSizeClassCount)
+    return nullptr;
+
+  ThreadState* thread_state = GetThreadState();
+  if (thread_state == nullptr)
+    return nullptr;
+
+  // Fast path: allocate from the slab owned by this thread.
+  SlabHeader* slab = thread_state->slabs[size_class];
+  if (slab != nullptr) {
+    void* alloc = AllocateFromSlab(slab);
+    if (alloc != nullptr)
+      return alloc;
+  }
+
+  slab = AcquireSlab(thread_state, size_class);
+  if (slab == nullptr)
+    return nullptr;
+
+  // Only the owner of a slab allocates from it, so the slab can't fill up
+  // under our feet.
+  void* alloc = AllocateFromSlab(slab);
+  DCHECK_NE(static_cast<void*>(nullptr), alloc);
+  return alloc;
+}
+
+bool SlabBlockHeap::Free(void* alloc) {
+  DCHECK_NE(static_cast<void*>(nullptr), alloc);
+  SlabHeader* slab = GetSlab(alloc);
+
+  // Fast path: an owned slab is never released, so the slot can be returned
+  // under the slab lock alone.
+  {
+    base::AutoLock slab_lock(slab->lock);
+    if (slab->owner != nullptr) {
+      FreeToSlab(slab, alloc);
+      return true;
+    }
+  }
+
+  // The slab is unowned, and may have to move to the list of partially used
+  // slabs or be released. The slot that is being freed keeps it alive until
+  // then.
+  ::common::AutoRecursiveLock lock(lock_);
+  bool release = false;
+  {
+    base::AutoLock slab_lock(slab->lock);
+    FreeToSlab(slab, alloc);
+    if (slab->owner != nullptr)
+      return true;
+
+    if (!slab->is_partial)
+      PushPartialSlab(slab);
+
+    // Keep the last partially used slab of a size class around, to avoid
+    // reserving and releasing a slab over and over.
+    release = slab->allocated_count == 0 &&
+        (slab->prev_partial != nullptr || slab->next_partial != nullptr);
+  }
+
+  if (release) {
+    RemovePartialSlab(slab);
+    ReleaseSlab(slab);
+  }
+  return true;
+}
+
+bool SlabBlockHeap::IsAllocated(const void* alloc) {
+  return false;
+}
+
+uint32_t SlabBlockHeap::GetAllocationSize(const void* alloc) {
+  DCHECK_NE(static_cast<void*>(nullptr), alloc);
+  return kBlockSizeClasses[GetSlab(alloc)->size_class];
+}
+
+void SlabBlockHeap::Lock() {
+  lock_.Acquire();
+}
+
+void SlabBlockHeap::Unlock() {
+  lock_.Release();
+}
+
+bool SlabBlockHeap::TryLock() {
+  return lock_.Try();
+}
+
+bool SlabBlockHeap::GetLockStatistics(
+    ::common::RecursiveLock::Statistics* statistics) {
+  lock_.GetStatistics(statistics);
+  return true;
+}
+
+void* SlabBlockHeap::AllocateBlock(uint32_t size,
+                                   uint32_t min_left_redzone_size,
+                                   uint32_t min_right_redzone_size,
+                                   BlockLayout* layout) {
+  DCHECK_NE(static_cast<BlockLayout*>(nullptr), layout);
+
+  if (!BlockPlanLayoutCached(kShadowRatio, kShadowRatio, size,
+                             min_left_redzone_size, min_right_redzone_size,
+                             layout)) {
+    return nullptr;
+  }
+
+  size_t size_class = GetSizeClass(layout->block_size);
+  if (size_class == kSizeClassCount)
+    return nullptr;
+
+  // Grow the right redzone so that the block exactly fills its slot.
+  uint32_t extra_size = kBlockSizeClasses[size_class] - layout->block_size;
+  if (extra_size != 0) {
+    if (!BlockPlanLayoutCached(kShadowRatio, kShadowRatio, size,
+                               min_left_redzone_size,
+                               layout->trailer_size +
+                                   layout->trailer_padding_size + extra_size,
+                               layout)) {
+      return nullptr;
+    }
+  }
+  DCHECK_EQ(kBlockSizeClasses[size_class], layout->block_size);
+
+  return Allocate(layout->block_size);
+}
+
+bool SlabBlockHeap::FreeBlock(const BlockInfo& block_info) {
+  DCHECK_NE(static_cast<BlockHeader*>(nullptr), block_info.header);
+  return Free(block_info.header);
+}
+
+size_t SlabBlockHeap::GetSizeClass(uint32_t bytes) {
+  const uint32_t* size_class = std::lower_bound(
+      kBlockSizeClasses, kBlockSizeClasses + kSizeClassCount, bytes);
+  return size_class - kBlockSizeClasses;
+}
+
+size_t SlabBlockHeap::GetSlabCount() {
+  ::common::AutoRecursiveLock lock(lock_);
+  return slab_count_;
+}
+
+SlabBlockHeap::ThreadState* SlabBlockHeap::GetThreadState() {
+  ThreadState* thread_state =
+      reinterpret_cast<ThreadState*>(::TlsGetValue(thread_state_tls_));
+  if (thread_state != nullptr)
+    return thread_state;
+
+  // This is the first time this thread uses the heap.
+  thread_state = reinterpret_cast<ThreadState*>(
+      internal_heap_->Allocate(sizeof(ThreadState)));
+  if (thread_state == nullptr)
+    return nullptr;
+  ::memset(thread_state, 0, sizeof(*thread_state));
+
+  {
+    ::common::AutoRecursiveLock lock(lock_);
+    thread_state->next = thread_states_;
+    thread_states_ = thread_state;
+  }
+
+  ::TlsSetValue(thread_state_tls_, thread_state);
+  return thread_state;
+}
+
+SlabBlockHeap::SlabHeader* SlabBlockHeap::GetSlab(const void* alloc) {
+  return reinterpret_cast<SlabHeader*>(
+      ::common::AlignDown(reinterpret_cast<uintptr_t>(alloc), kSlabSize));
+}
+
+void* SlabBlockHeap::AllocateFromSlab(SlabHeader* slab) {
+  DCHECK_NE(static_cast<SlabHeader*>(nullptr), slab);
+
+  base::AutoLock slab_lock(slab->lock);
+  void* alloc = slab->free_list;
+  if (alloc != nullptr) {
+    slab->free_list = *reinterpret_cast<void**>(alloc);
+  } else if (slab->next_unused_slot < slab->slot_count) {
+    alloc = reinterpret_cast<uint8_t*>(slab) + kSlabHeaderSize +
+        slab->next_unused_slot * kBlockSizeClasses[slab->size_class];
+    ++slab->next_unused_slot;
+  } else {
+    return nullptr;
+  }
+
+  ++slab->allocated_count;
+  return alloc;
+}
+
+void SlabBlockHeap::FreeToSlab(SlabHeader* slab, void* alloc) {
+  DCHECK_NE(static_cast<SlabHeader*>(nullptr), slab);
+  slab->lock.AssertAcquired();
+  DCHECK_EQ(0u, (reinterpret_cast<uint8_t*>(alloc) -
+                 reinterpret_cast<uint8_t*>(slab) - kSlabHeaderSize) %
+                kBlockSizeClasses[slab->size_class]);
+  DCHECK_LT(0u, slab->allocated_count);
+
+  *reinterpret_cast<void**>(alloc) = slab->free_list;
+  slab->free_list = alloc;
+  --slab->allocated_count;
+}
+
+SlabBlockHeap::SlabHeader* SlabBlockHeap::AcquireSlab(
+    ThreadState* thread_state, size_t size_class) {
+  DCHECK_NE(static_cast<ThreadState*>(nullptr), thread_state);
+  DCHECK_GT(kSizeClassCount, size_class);
+
+  ::common::AutoRecursiveLock lock(lock_);
+
+  // Give up the slab owned by this thread, unless slots have been freed to it
+  // in the meantime.
+  SlabHeader* slab = thread_state->slabs[size_class];
+  if (slab != nullptr) {
+    base::AutoLock slab_lock(slab->lock);
+    if (slab->allocated_count < slab->slot_count)
+      return slab;
+    slab->owner = nullptr;
+    thread_state->slabs[size_class] = nullptr;
+  }
+
+  slab = partial_slabs_[size_class];
+  if (slab != nullptr) {
+    RemovePartialSlab(slab);
+  } else {
+    slab = ReserveSlab(size_class);
+    if (slab == nullptr)
+      return nullptr;
+  }
+
+  {
+    base::AutoLock slab_lock(slab->lock);
+    DCHECK_EQ(static_cast<ThreadState*>(nullptr), slab->owner);
+    slab->owner = thread_state;
+  }
+  thread_state->slabs[size_class] = slab;
+  return slab;
+}
+
+SlabBlockHeap::SlabHeader* SlabBlockHeap::ReserveSlab(size_t size_class) {
+  DCHECK_GT(kSizeClassCount, size_class);
+
+  void* address = ::VirtualAlloc(nullptr, kSlabSize, MEM_RESERVE | MEM_COMMIT,
+                                 PAGE_READWRITE);
+  if (address == nullptr)
+    return nullptr;
+  DCHECK(::common::IsAligned(address, kSlabSize));
+
+  // Report the whole slab at once. The slots are carved out of it by the heap
+  // manager as blocks are allocated.
+  memory_notifier_->NotifyFutureHeapUse(address, kSlabSize);
+  memory_notifier_->NotifyInternalUse(address, kSlabHeaderSize);
+
+  SlabHeader* slab = new (address) SlabHeader();
+  slab->owner = nullptr;
+  slab->size_class = size_class;
+  slab->slot_count =
+      (kSlabSize - kSlabHeaderSize) / kBlockSizeClasses[size_class];
+  slab->allocated_count = 0;
+  slab->next_unused_slot = 0;
+  slab->free_list = nullptr;
+  slab->prev = nullptr;
+  slab->next = slabs_;
+  slab->prev_partial = nullptr;
+  slab->next_partial = nullptr;
+  slab->is_partial = false;
+
+  if (slabs_ != nullptr)
+    slabs_->prev = slab;
+  slabs_ = slab;
+  ++slab_count_;
+  return slab;
+}
+
+void SlabBlockHeap::ReleaseSlab(SlabHeader* slab) {
+  DCHECK_NE(static_cast<SlabHeader*>(nullptr), slab);
+  DCHECK(!slab->is_partial);
+
+  if (slab->prev != nullptr)
+    slab->prev->next = slab->next;
+  else
+    slabs_ = slab->next;
+  if (slab->next != nullptr)
+    slab->next->prev = slab->prev;
+  --slab_count_;
+
+  slab->~SlabHeader();
+  memory_notifier_->NotifyReturnedToOS(slab, kSlabSize);
+  ::VirtualFree(slab, 0, MEM_RELEASE);
+}
+
+void SlabBlockHeap::PushPartialSlab(SlabHeader* slab) {
+  DCHECK_NE(static_cast<SlabHeader*>(nullptr), slab);
+  DCHECK(!slab->is_partial);
+
+  SlabHeader** head = &partial_slabs_[slab->size_class];
+  slab->prev_partial = nullptr;
+  slab->next_partial = *head;
+  if (*head != nullptr)
+    (*head)->prev_partial = slab;
+  *head = slab;
+  slab->is_partial = true;
+}
+
+void SlabBlockHeap::RemovePartialSlab(SlabHeader* slab) {
+  DCHECK_NE(static_cast<SlabHeader*>(nullptr), slab);
+  DCHECK(slab->is_partial);
+
+  if (slab->prev_partial != nullptr)
+    slab->prev_partial->next_partial = slab->next_partial;
+  else
+    partial_slabs_[slab->size_class] = slab->next_partial;
+  if (slab->next_partial != nullptr)
+    slab->next_partial->prev_partial = slab->prev_partial;
+  slab->prev_partial = nullptr;
+  slab->next_partial = nullptr;
+  slab->is_partial = false;
+}
+
+}  // namespace heaps
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,243 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares SlabBlockHeap, a block heap made of size-class segregated slabs
+// reserved directly from the OS. It serves the small allocations of the heap
+// manager without going through the Windows heap.
+
+#ifndef SYZYGY_AGENT_ASAN_HEAPS_SLAB_BLOCK_HEAP_H_
+#define SYZYGY_AGENT_ASAN_HEAPS_SLAB_BLOCK_HEAP_H_
+
+#include <windows.h>
+
+#include "base/logging.h"
+#include "base/synchronization/lock.h"
+#include "syzygy/agent/asan/block.h"
+#include "syzygy/agent/asan/heap.h"
+#include "syzygy/agent/asan/memory_notifier.h"
+#include "syzygy/common/recursive_lock.h"
+
+namespace agent {
+namespace asan {
+namespace heaps {
+
+// A slab heap reserves memory in slabs of kSlabSize bytes, each of which is
+// dedicated to a single size class and carved into slots of that size. A
+// slab starts with its header, which holds its bookkeeping, followed by its
+// slots:
+//
+// +--------+--------+--------+--------+- - -+--------+--------+
+// | header | slot 0 | slot 1 | slot 2 | ... | slot n | unused |
+// +--------+--------+--------+--------+- - -+--------+--------+
+//
+// Free slots are chained into a per-slab free list, and slots that have never
+// been used are handed out in address order.
+//
+// Each thread owns at most one slab per size class, and allocates from it
+// under that slab's lock alone. Frees go to the slab containing the slot,
+// whichever thread owns it. A thread gives up its slab once it's full, and
+// adopts a slab that has free slots again or reserves a new one under the
+// heap lock. Unowned slabs are returned to the OS when they become empty,
+// unless they are the last partially used slab of their size class. Slabs
+// owned by threads that have exited are only released with the heap.
+//
+// Whole slabs are reported to the memory notifier when they are reserved and
+// released, and their headers are reported as internal memory, so the shadow
+// memory isn't updated for each slot.
+//
+// Blocks are laid out with their right redzone grown to fill their slot, so
+// that the block size always matches the size class.
+class SlabBlockHeap : public BlockHeapInterface {
+ public:
+  // The number of distinct size classes. The slot sizes of each class are
+  // given by kBlockSizeClasses.
+  static const size_t kSizeClassCount = kBlockSizeClassCount;
+
+  // The largest allocation that can be served by this heap. Anything bigger
+  // than this will always fail a call to 'Allocate' or 'AllocateBlock'.
+  static const uint32_t kMaximumAllocationSize = 4096;
+
+  // The size of a slab. This is the allocation granularity of the OS, so that
+  // each slab is a single aligned reservation.
+  static const size_t kSlabSize = 64 * 1024;
+
+  // The size of the header at the beginning of each slab.
+  static const size_t kSlabHeaderSize = 256;
+
+  // Constructor.
+  // @param memory_notifier The MemoryNotifierInterface used to report
+  //     the reservation and release of slabs.
+  // @param internal_heap The heap to use for making internal allocations.
+  SlabBlockHeap(MemoryNotifierInterface* memory_notifier,
+                HeapInterface* internal_heap);
+
+  // Virtual destructor. Returns all the slabs to the OS.
+  virtual ~SlabBlockHeap();
+
+  // @name HeapInterface functions.
+  // @{
+  virtual HeapType GetHeapType() const;
+  virtual uint32_t GetHeapFeatures() const;
+  virtual void* Allocate(uint32_t bytes);
+  virtual bool Free(void* alloc);
+  virtual bool IsAllocated(const void* alloc);
+  virtual uint32_t GetAllocationSize(const void* alloc);
+  // @note Locking the heap blocks the reservation and release of slabs, and
+  //     the frees to unowned slabs. Allocations from and frees to the slabs
+  //     owned by a thread only take the lock of that slab.
+  virtual void Lock();
+  virtual void Unlock();
+  virtual bool TryLock();
+  virtual bool GetLockStatistics(
+      ::common::RecursiveLock::Statistics* statistics);
+  // @}
+
+  // @name BlockHeapInterface functions.
+  // @{
+  virtual void* AllocateBlock(uint32_t size,
+                              uint32_t min_left_redzone_size,
+                              uint32_t min_right_redzone_size,
+                              BlockLayout* layout);
+  virtual bool FreeBlock(const BlockInfo& block_info);
+  // @}
+
+  // @returns the index of the smallest size class that can hold an
+  //     allocation of the given size, or kSizeClassCount if there is none.
+  // @param bytes The size of the allocation.
+  static size_t GetSizeClass(uint32_t bytes);
+
+  // @returns the number of slabs currently reserved by the heap.
+  size_t GetSlabCount();
+
+ protected:
+  struct ThreadState;
+
+  // The header found at the beginning of each slab.
+  struct SlabHeader {
+    // Protects the slots of the slab.
+    base::Lock lock;
+    // The thread owning this slab, if any. Only changes under both the heap
+    // lock and lock.
+    ThreadState* owner;
+    // The size class of the slab.
+    size_t size_class;
+    // The number of slots in the slab.
+    size_t slot_count;
+    // The number of allocated slots. Under lock.
+    size_t allocated_count;
+    // The index of the first slot that has never been allocated. Under lock.
+    size_t next_unused_slot;
+    // The first free slot, each free slot holding a pointer to the next one.
+    // Under lock.
+    void* free_list;
+    // The neighbours of the slab in the list of all slabs. Under the heap
+    // lock.
+    SlabHeader* prev;
+    SlabHeader* next;
+    // The neighbours of the slab in the list of partially used slabs of its
+    // size class. Under the heap lock.
+    SlabHeader* prev_partial;
+    SlabHeader* next_partial;
+    // True if the slab is in the list of partially used slabs of its size
+    // class. Under the heap lock.
+    bool is_partial;
+  };
+
+  // The state of a thread using the heap. These are chained into a list so
+  // that they can be freed with the heap.
+  struct ThreadState {
+    // The slab owned by the thread in each size class, if any.
+    SlabHeader* slabs[kSizeClassCount];
+    ThreadState* next;
+  };
+
+  // @returns the state associated with the calling thread, creating it if
+  //     necessary. Returns nullptr if the state can't be created.
+  ThreadState* GetThreadState();
+
+  // @returns the slab containing a given slot.
+  // @param alloc The address of the slot.
+  static SlabHeader* GetSlab(const void* alloc);
+
+  // Allocates a slot from a slab.
+  // @param slab The slab to allocate from.
+  // @returns the slot, or nullptr if the slab is full.
+  static void* AllocateFromSlab(SlabHeader* slab);
+
+  // Returns a slot to its slab.
+  // @param slab The slab containing the slot. Must be locked.
+  // @param alloc The slot to return.
+  static void FreeToSlab(SlabHeader* slab, void* alloc);
+
+  // Makes the calling thread own a slab with free slots for a size class,
+  // giving up the full slab it currently owns.
+  // @param thread_state The state of the calling thread.
+  // @param size_class The size class of the slab.
+  // @returns the slab, or nullptr if none could be reserved.
+  SlabHeader* AcquireSlab(ThreadState* thread_state, size_t size_class);
+
+  // Reserves a new slab for a size class. Under lock_.
+  // @param size_class The size class of the slab.
+  // @returns the slab, or nullptr if the memory couldn't be reserved.
+  SlabHeader* ReserveSlab(size_t size_class);
+
+  // Returns a slab to the OS. Under lock_.
+  // @param slab The slab to release. Must not be in a list of partially used
+  //     slabs.
+  void ReleaseSlab(SlabHeader* slab);
+
+  // Adds a slab to the list of partially used slabs of its size class.
+  // Under lock_.
+  // @param slab The slab to add.
+  void PushPartialSlab(SlabHeader* slab);
+
+  // Removes a slab from the list of partially used slabs of its size class.
+  // Under lock_.
+  // @param slab The slab to remove.
+  void RemovePartialSlab(SlabHeader* slab);
+
+  // The list of all the slabs reserved by the heap. Under lock_.
+  SlabHeader* slabs_;
+
+  // The number of slabs reserved by the heap. Under lock_.
+  size_t slab_count_;
+
+  // The unowned slabs that have free slots, per size class. Under lock_.
+  SlabHeader* partial_slabs_[kSizeClassCount];
+
+  // The heap used to allocate the bookkeeping.
+  HeapInterface* internal_heap_;
+
+  // The interface that will be notified of the slab reservations. Has its own
+  // locking.
+  MemoryNotifierInterface* memory_notifier_;
+
+  // The TLS slot holding the calling thread's state.
+  DWORD thread_state_tls_;
+
+  // The list of all thread states. Under lock_.
+  ThreadState* thread_states_;
+
+  // The global lock for this heap.
+  ::common::RecursiveLock lock_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SlabBlockHeap);
+};
+
+}  // namespace heaps
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_HEAPS_SLAB_BLOCK_HEAP_H_
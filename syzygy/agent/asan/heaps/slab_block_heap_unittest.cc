@@ -0,0 +1,229 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/heaps/slab_block_heap.h"
+
+#include <set>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/unittest_util.h"
+#include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+namespace heaps {
+
+namespace {
+
+using ::testing::_;
+
+testing::DummyHeap dummy_heap;
+agent::asan::memory_notifiers::NullMemoryNotifier dummy_notifier;
+
+// A SlabBlockHeap that uses a null memory notifier.
+class TestSlabBlockHeap : public SlabBlockHeap {
+ public:
+  TestSlabBlockHeap() : SlabBlockHeap(&dummy_notifier, &dummy_heap) {
+  }
+
+  explicit TestSlabBlockHeap(MemoryNotifierInterface* memory_notifier)
+      : SlabBlockHeap(memory_notifier, &dummy_heap) {
+  }
+};
+
+// The number of slots in a slab of the largest size class.
+const size_t kLargestSlotCount =
+    (SlabBlockHeap::kSlabSize - SlabBlockHeap::kSlabHeaderSize) /
+    SlabBlockHeap::kMaximumAllocationSize;
+
+// Allocates blocks on one thread, to be freed on another.
+class AllocatingThread : public base::SimpleThread {
+ public:
+  AllocatingThread(SlabBlockHeap* heap, std::vector<BlockInfo>* blocks)
+      : base::SimpleThread("AllocatingThread"), heap_(heap), blocks_(blocks) {
+  }
+
+  void Run() override {
+    for (uint32_t i = 0; i < 1000; ++i) {
+      BlockLayout layout = {};
+      void* alloc = heap_->AllocateBlock(i % 300, 0, sizeof(BlockTrailer),
+                                         &layout);
+      ASSERT_NE(static_cast<void*>(nullptr), alloc);
+      BlockInfo block = {};
+      BlockInitialize(layout, alloc, &block);
+      blocks_->push_back(block);
+    }
+  }
+
+ private:
+  SlabBlockHeap* heap_;
+  std::vector<BlockInfo>* blocks_;
+};
+
+}  // namespace
+
+TEST(SlabBlockHeapTest, GetHeapTypeIsValid) {
+  TestSlabBlockHeap h;
+  EXPECT_EQ(kSlabBlockHeap, h.GetHeapType());
+}
+
+TEST(SlabBlockHeapTest, FeaturesAreValid) {
+  TestSlabBlockHeap h;
+  EXPECT_EQ(HeapInterface::kHeapReportsReservations |
+                HeapInterface::kHeapSupportsGetAllocationSize |
+                HeapInterface::kHeapGetAllocationSizeIsUpperBound,
+            h.GetHeapFeatures());
+}
+
+TEST(SlabBlockHeapTest, GetSizeClass) {
+  EXPECT_EQ(0u, SlabBlockHeap::GetSizeClass(0));
+  EXPECT_EQ(0u, SlabBlockHeap::GetSizeClass(16));
+  EXPECT_EQ(1u, SlabBlockHeap::GetSizeClass(17));
+  EXPECT_EQ(SlabBlockHeap::kSizeClassCount - 1,
+            SlabBlockHeap::GetSizeClass(SlabBlockHeap::kMaximumAllocationSize));
+  EXPECT_EQ(SlabBlockHeap::kSizeClassCount,
+            SlabBlockHeap::GetSizeClass(
+                SlabBlockHeap::kMaximumAllocationSize + 1));
+}
+
+TEST(SlabBlockHeapTest, AllocateTooBig) {
+  TestSlabBlockHeap h;
+  BlockLayout layout = {};
+  EXPECT_EQ(static_cast<void*>(nullptr),
+            h.Allocate(SlabBlockHeap::kMaximumAllocationSize + 1));
+  EXPECT_EQ(static_cast<void*>(nullptr),
+            h.AllocateBlock(SlabBlockHeap::kMaximumAllocationSize, 0, 0,
+                            &layout));
+  EXPECT_EQ(0u, h.GetSlabCount());
+}
+
+TEST(SlabBlockHeapTest, EndToEnd) {
+  TestSlabBlockHeap h;
+  std::set<void*> allocs;
+  std::vector<BlockInfo> blocks;
+
+  for (uint32_t size = 0; size < 4000; size = size * 3 / 2 + 1) {
+    BlockLayout layout = {};
+    void* alloc = h.AllocateBlock(size, 0, sizeof(BlockTrailer), &layout);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    EXPECT_TRUE(::common::IsAligned(alloc, kShadowRatio));
+    EXPECT_TRUE(allocs.insert(alloc).second);
+
+    // The block fills its slot.
+    size_t size_class = SlabBlockHeap::GetSizeClass(layout.block_size);
+    ASSERT_GT(SlabBlockHeap::kSizeClassCount, size_class);
+    EXPECT_EQ(kBlockSizeClasses[size_class], layout.block_size);
+    EXPECT_EQ(layout.block_size, h.GetAllocationSize(alloc));
+
+    BlockInfo block = {};
+    BlockInitialize(layout, alloc, &block);
+    EXPECT_EQ(size, block.body_size);
+    blocks.push_back(block);
+  }
+
+  for (const auto& block : blocks)
+    EXPECT_TRUE(h.FreeBlock(block));
+}
+
+TEST(SlabBlockHeapTest, SlotsAreReused) {
+  TestSlabBlockHeap h;
+  void* alloc1 = h.Allocate(100);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc1);
+  void* alloc2 = h.Allocate(100);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc2);
+  EXPECT_NE(alloc1, alloc2);
+
+  // The most recently freed slot is handed out first.
+  EXPECT_TRUE(h.Free(alloc1));
+  EXPECT_EQ(alloc1, h.Allocate(100));
+
+  EXPECT_TRUE(h.Free(alloc1));
+  EXPECT_TRUE(h.Free(alloc2));
+  EXPECT_EQ(1u, h.GetSlabCount());
+}
+
+TEST(SlabBlockHeapTest, SlabsAreReleased) {
+  TestSlabBlockHeap h;
+
+  // Fill three slabs of the largest size class, the last one partially.
+  std::vector<void*> allocs;
+  for (size_t i = 0; i < 2 * kLargestSlotCount + 1; ++i) {
+    void* alloc = h.Allocate(SlabBlockHeap::kMaximumAllocationSize);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    allocs.push_back(alloc);
+  }
+  EXPECT_EQ(3u, h.GetSlabCount());
+
+  // The first two slabs are full and given up. The first one to become empty
+  // is kept as the last partially used slab of its size class, the second one
+  // is released. The third one is still owned by this thread.
+  for (void* alloc : allocs)
+    EXPECT_TRUE(h.Free(alloc));
+  EXPECT_EQ(2u, h.GetSlabCount());
+
+  // The kept slab is adopted once the owned one is full again.
+  for (size_t i = 0; i < 2 * kLargestSlotCount; ++i)
+    EXPECT_NE(static_cast<void*>(nullptr),
+              h.Allocate(SlabBlockHeap::kMaximumAllocationSize));
+  EXPECT_EQ(2u, h.GetSlabCount());
+}
+
+TEST(SlabBlockHeapTest, SlabsAreReportedInBulk) {
+  testing::MockMemoryNotifier mock_notifier;
+  EXPECT_CALL(mock_notifier,
+              NotifyFutureHeapUse(_, SlabBlockHeap::kSlabSize)).Times(1);
+  EXPECT_CALL(mock_notifier,
+              NotifyInternalUse(_, SlabBlockHeap::kSlabHeaderSize)).Times(1);
+  EXPECT_CALL(mock_notifier,
+              NotifyReturnedToOS(_, SlabBlockHeap::kSlabSize)).Times(1);
+
+  TestSlabBlockHeap h(&mock_notifier);
+  std::vector<void*> allocs;
+  for (size_t i = 0; i < 100; ++i) {
+    void* alloc = h.Allocate(64);
+    ASSERT_NE(static_cast<void*>(nullptr), alloc);
+    allocs.push_back(alloc);
+  }
+  for (void* alloc : allocs)
+    EXPECT_TRUE(h.Free(alloc));
+}
+
+TEST(SlabBlockHeapTest, FreeOnAnotherThread) {
+  TestSlabBlockHeap h;
+  std::vector<BlockInfo> blocks;
+  AllocatingThread thread(&h, &blocks);
+  thread.Start();
+  thread.Join();
+
+  // The slabs of the dead thread stay owned, and take frees from this one.
+  ASSERT_EQ(1000u, blocks.size());
+  for (const auto& block : blocks)
+    EXPECT_TRUE(h.FreeBlock(block));
+  size_t slab_count = h.GetSlabCount();
+  EXPECT_LT(0u, slab_count);
+
+  // This thread gets slabs of its own.
+  void* alloc = h.Allocate(100);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_EQ(slab_count + 1, h.GetSlabCount());
+  EXPECT_TRUE(h.Free(alloc));
+}
+
+}  // namespace heaps
+}  // namespace asan
+}  // namespace agent
@@ -97,6 +97,12 @@ bool WinHeap::TryLock() {
   return lock_.Try();
 }
 
+bool WinHeap::GetLockStatistics(
+    ::common::RecursiveLock::Statistics* statistics) {
+  lock_.GetStatistics(statistics);
+  return true;
+}
+
 }  // namespace heaps
 }  // namespace asan
 }  // namespace agent
@@ -50,6 +50,8 @@ class WinHeap : public HeapInterface {
   virtual void Lock();
   virtual void Unlock();
   virtual bool TryLock();
+  virtual bool GetLockStatistics(
+      ::common::RecursiveLock::Statistics* statistics);
   // @}
 
  protected:
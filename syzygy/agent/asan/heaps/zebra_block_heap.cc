@@ -33,40 +33,48 @@ const size_t ZebraBlockHeap::kMaximumBlockAllocationSize =
 ZebraBlockHeap::ZebraBlockHeap(size_t heap_size,
                                MemoryNotifierInterface* memory_notifier,
                                HeapInterface* internal_heap)
+    : ZebraBlockHeap(heap_size, 1, memory_notifier, internal_heap) {
+}
+
+ZebraBlockHeap::ZebraBlockHeap(size_t region_size,
+                               size_t max_region_count,
+                               MemoryNotifierInterface* memory_notifier,
+                               HeapInterface* internal_heap)
     : heap_address_(NULL),
-      // Makes the heap_size a multiple of kSlabSize to avoid incomplete slabs
-      // at the end of the reserved memory.
-      heap_size_(::common::AlignUp(heap_size, kSlabSize)),
-      slab_count_(heap_size_ / kSlabSize),
-      slab_info_(HeapAllocator<SlabInfo>(internal_heap)),
+      // Makes the region_size a multiple of kSlabSize to avoid incomplete
+      // slabs at the end of the reserved memory.
+      heap_size_(::common::AlignUp(region_size, kSlabSize)),
+      slabs_per_region_(heap_size_ / kSlabSize),
+      slab_count_(0),
+      regions_(HeapAllocator<RegionInfo>(internal_heap)),
+      empty_region_count_(0),
       quarantine_ratio_(::common::kDefaultZebraBlockHeapQuarantineRatio),
-      free_slabs_(slab_count_,
+      free_slabs_(slabs_per_region_ * max_region_count,
                   HeapAllocator<size_t>(internal_heap)),
-      quarantine_(slab_count_,
+      quarantine_(slabs_per_region_ * max_region_count,
                   HeapAllocator<size_t>(internal_heap)),
+      slab_info_(HeapAllocator<SlabInfo>(internal_heap)),
       memory_notifier_(memory_notifier) {
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
+  DCHECK_LT(0u, max_region_count);
 
-  // Allocate the chunk of memory directly from the OS.
-  heap_address_ = static_cast<uint8_t*>(::VirtualAlloc(
-      NULL, heap_size_, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
-  CHECK_NE(static_cast<uint8_t*>(nullptr), heap_address_);
-  DCHECK(::common::IsAligned(heap_address_, GetPageSize()));
-  memory_notifier_->NotifyFutureHeapUse(heap_address_, heap_size_);
+  RegionInfo empty_region = {};
+  regions_.resize(max_region_count, empty_region);
 
-  // Initialize the metadata describing the state of our heap.
-  slab_info_.resize(slab_count_);
-  for (size_t i = 0; i < slab_count_; ++i) {
-    slab_info_[i].state = kFreeSlab;
-    ::memset(&slab_info_[i].info, 0, sizeof(slab_info_[i].info));
-    free_slabs_.push(i);
-  }
+  // The first region is reserved right away and is never released.
+  CHECK(ReserveRegion());
+  heap_address_ = regions_[0].address;
 }
 
 ZebraBlockHeap::~ZebraBlockHeap() {
   DCHECK_NE(static_cast<uint8_t*>(nullptr), heap_address_);
-  CHECK_NE(FALSE, ::VirtualFree(heap_address_, 0, MEM_RELEASE));
-  memory_notifier_->NotifyReturnedToOS(heap_address_, heap_size_);
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    if (regions_[i].address == nullptr)
+      continue;
+    CHECK_NE(FALSE, ::VirtualFree(regions_[i].address, 0, MEM_RELEASE));
+    memory_notifier_->NotifyReturnedToOS(regions_[i].address, heap_size_);
+    regions_[i].address = nullptr;
+  }
   heap_address_ = NULL;
 }
 
@@ -107,6 +115,13 @@ bool ZebraBlockHeap::Free(void* alloc) {
   ::memset(&slab_info_[slab_index].info, 0,
            sizeof(slab_info_[slab_index].info));
   free_slabs_.push(slab_index);
+
+  size_t region_index = slab_index / slabs_per_region_;
+  RegionInfo* region = &regions_[region_index];
+  ++region->free_slab_count;
+  if (region_index != 0 && region->free_slab_count == slabs_per_region_)
+    ++empty_region_count_;
+  ReleaseEmptyRegions();
   return true;
 }
 
@@ -150,6 +165,12 @@ bool ZebraBlockHeap::TryLock() {
   return lock_.Try();
 }
 
+bool ZebraBlockHeap::GetLockStatistics(
+    ::common::RecursiveLock::Statistics* statistics) {
+  lock_.GetStatistics(statistics);
+  return true;
+}
+
 void* ZebraBlockHeap::AllocateBlock(uint32_t size,
                                     uint32_t min_left_redzone_size,
                                     uint32_t min_right_redzone_size,
@@ -163,13 +184,13 @@ void* ZebraBlockHeap::AllocateBlock(uint32_t size,
     return NULL;
 
   // Plan the block layout.
-  if (!BlockPlanLayout(static_cast<uint32_t>(GetPageSize()),
-                       kShadowRatio,
-                       size,
-                       min_left_redzone_size,
-                       std::max(static_cast<uint32_t>(GetPageSize()),
-                                min_right_redzone_size),
-                       layout)) {
+  if (!BlockPlanLayoutCached(static_cast<uint32_t>(GetPageSize()),
+                             kShadowRatio,
+                             size,
+                             min_left_redzone_size,
+                             std::max(static_cast<uint32_t>(GetPageSize()),
+                                      min_right_redzone_size),
+                             layout)) {
     return nullptr;
   }
 
@@ -273,18 +294,32 @@ void ZebraBlockHeap::set_quarantine_ratio(float quarantine_ratio) {
   quarantine_ratio_ = quarantine_ratio;
 }
 
+size_t ZebraBlockHeap::GetRegionCount() {
+  ::common::AutoRecursiveLock lock(lock_);
+  return slab_count_ / slabs_per_region_;
+}
+
 ZebraBlockHeap::SlabInfo* ZebraBlockHeap::AllocateImpl(uint32_t bytes) {
   CHECK_LE(bytes, (1u << 30));
   if (bytes == 0 || bytes > GetPageSize())
     return NULL;
   ::common::AutoRecursiveLock lock(lock_);
 
-  if (free_slabs_.empty())
+  if (free_slabs_.empty() && !ReserveRegion())
     return NULL;
 
   size_t slab_index = free_slabs_.front();
   DCHECK_NE(kInvalidSlabIndex, slab_index);
   free_slabs_.pop();
+
+  size_t region_index = slab_index / slabs_per_region_;
+  RegionInfo* region = &regions_[region_index];
+  DCHECK_LT(0u, region->free_slab_count);
+  if (region_index != 0 && region->free_slab_count == slabs_per_region_) {
+    DCHECK_LT(0u, empty_region_count_);
+    --empty_region_count_;
+  }
+  --region->free_slab_count;
   uint8_t* slab_address = GetSlabAddress(slab_index);
   DCHECK_NE(static_cast<uint8_t*>(nullptr), slab_address);
 
@@ -304,6 +339,81 @@ ZebraBlockHeap::SlabInfo* ZebraBlockHeap::AllocateImpl(uint32_t bytes) {
   return slab_info;
 }
 
+bool ZebraBlockHeap::ReserveRegion() {
+  size_t region_index = 0;
+  while (region_index < regions_.size() &&
+         regions_[region_index].address != nullptr) {
+    ++region_index;
+  }
+  if (region_index == regions_.size())
+    return false;
+
+  // Allocate the chunk of memory directly from the OS.
+  uint8_t* address = static_cast<uint8_t*>(::VirtualAlloc(
+      NULL, heap_size_, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+  if (address == nullptr)
+    return false;
+  DCHECK(::common::IsAligned(address, GetPageSize()));
+  memory_notifier_->NotifyFutureHeapUse(address, heap_size_);
+
+  RegionInfo* region = &regions_[region_index];
+  region->address = address;
+  region->free_slab_count = slabs_per_region_;
+  slab_count_ += slabs_per_region_;
+  if (region_index != 0)
+    ++empty_region_count_;
+
+  // Initialize the metadata describing the state of the new slabs.
+  size_t first_slab_index = region_index * slabs_per_region_;
+  size_t end_slab_index = first_slab_index + slabs_per_region_;
+  if (slab_info_.size() < end_slab_index)
+    slab_info_.resize(end_slab_index);
+  for (size_t i = first_slab_index; i < end_slab_index; ++i) {
+    slab_info_[i].state = kFreeSlab;
+    ::memset(&slab_info_[i].info, 0, sizeof(slab_info_[i].info));
+    free_slabs_.push(i);
+  }
+
+  return true;
+}
+
+void ZebraBlockHeap::ReleaseEmptyRegions() {
+  if (empty_region_count_ == 0)
+    return;
+
+  // Keep the empty regions while the other regions are nearly full, as they
+  // would be reserved again right away.
+  DCHECK_LE(empty_region_count_ * slabs_per_region_, free_slabs_.size());
+  size_t other_free_slabs =
+      free_slabs_.size() - empty_region_count_ * slabs_per_region_;
+  if (other_free_slabs < slabs_per_region_ / 4)
+    return;
+
+  for (size_t i = 1; i < regions_.size(); ++i) {
+    RegionInfo* region = &regions_[i];
+    if (region->address == nullptr ||
+        region->free_slab_count != slabs_per_region_) {
+      continue;
+    }
+    CHECK_NE(FALSE, ::VirtualFree(region->address, 0, MEM_RELEASE));
+    memory_notifier_->NotifyReturnedToOS(region->address, heap_size_);
+    region->address = nullptr;
+    region->free_slab_count = 0;
+    slab_count_ -= slabs_per_region_;
+  }
+  empty_region_count_ = 0;
+
+  // Remove the slabs of the released regions from the free slabs, keeping the
+  // order of the others.
+  size_t free_slab_count = free_slabs_.size();
+  for (size_t i = 0; i < free_slab_count; ++i) {
+    size_t slab_index = free_slabs_.front();
+    free_slabs_.pop();
+    if (regions_[slab_index / slabs_per_region_].address != nullptr)
+      free_slabs_.push(slab_index);
+  }
+}
+
 bool ZebraBlockHeap::QuarantineInvariantIsSatisfied() {
   return quarantine_.empty() ||
          (quarantine_.size() / static_cast<float>(slab_count_) <=
@@ -311,16 +421,26 @@ bool ZebraBlockHeap::QuarantineInvariantIsSatisfied() {
 }
 
 uint8_t* ZebraBlockHeap::GetSlabAddress(size_t index) {
-  if (index >= slab_count_)
+  size_t region_index = index / slabs_per_region_;
+  if (region_index >= regions_.size())
     return NULL;
-  return heap_address_ + index * kSlabSize;
+  uint8_t* region_address = regions_[region_index].address;
+  if (region_address == nullptr)
+    return NULL;
+  return region_address + (index % slabs_per_region_) * kSlabSize;
 }
 
 size_t ZebraBlockHeap::GetSlabIndex(const void* address) {
-  if (address < heap_address_ || address >= heap_address_ + heap_size_)
-    return kInvalidSlabIndex;
-  return (static_cast<const uint8_t*>(address) - heap_address_) /
-         kSlabSize;
+  const uint8_t* addr = static_cast<const uint8_t*>(address);
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    const uint8_t* region_address = regions_[i].address;
+    if (region_address == nullptr)
+      continue;
+    if (addr < region_address || addr >= region_address + heap_size_)
+      continue;
+    return i * slabs_per_region_ + (addr - region_address) / kSlabSize;
+  }
+  return kInvalidSlabIndex;
 }
 
 }  // namespace heaps
@@ -66,6 +66,11 @@ namespace heaps {
 // +--------+----------------+------+--+-------------------------+---------+
 // |-header-|                |-body-|                            |-trailer-|
 //
+// The heap starts with a single region of slabs. When all of its slabs are in
+// use it reserves additional regions of the same size, up to a maximum region
+// count, and it returns the additional regions to the OS once they are empty
+// again.
+//
 // Calling Free on a quarantined address is an invalid operation.
 class ZebraBlockHeap : public BlockHeapInterface,
                        public BlockQuarantineInterface {
@@ -81,7 +86,7 @@ class ZebraBlockHeap : public BlockHeapInterface,
   // than this will always fail a call to 'AllocateBlock'.
   static const size_t kMaximumBlockAllocationSize;
 
-  // Constructor.
+  // Constructor. The heap made by this constructor never grows.
   // @param heap_size The amount of memory reserved by the heap in bytes.
   // @param memory_notifier The MemoryNotifierInterface used to report
   //     allocation information.
@@ -90,6 +95,19 @@ class ZebraBlockHeap : public BlockHeapInterface,
                  MemoryNotifierInterface* memory_notifier,
                  HeapInterface* internal_heap);
 
+  // Constructor.
+  // @param region_size The amount of memory reserved by each region of the
+  //     heap in bytes.
+  // @param max_region_count The maximum number of regions that the heap may
+  //     reserve. Must be at least 1.
+  // @param memory_notifier The MemoryNotifierInterface used to report
+  //     allocation information.
+  // @param internal_heap The heap to use for making internal allocations.
+  ZebraBlockHeap(size_t region_size,
+                 size_t max_region_count,
+                 MemoryNotifierInterface* memory_notifier,
+                 HeapInterface* internal_heap);
+
   // Virtual destructor. Frees all the allocated memory.
   virtual ~ZebraBlockHeap();
 
@@ -104,6 +122,8 @@ class ZebraBlockHeap : public BlockHeapInterface,
   virtual void Lock();
   virtual void Unlock();
   virtual bool TryLock();
+  virtual bool GetLockStatistics(
+      ::common::RecursiveLock::Statistics* statistics);
   // @}
 
   // @name BlockHeapInterface functions.
@@ -138,6 +158,12 @@ class ZebraBlockHeap : public BlockHeapInterface,
   // Set the ratio of the memory used by the quarantine.
   void set_quarantine_ratio(float quarantine_ratio);
 
+  // @returns the number of regions currently reserved by the heap.
+  size_t GetRegionCount();
+
+  // @returns the maximum number of regions that the heap may reserve.
+  size_t max_region_count() const { return regions_.size(); }
+
  protected:
   // The set of possible states of the slabs.
   enum SlabState {
@@ -153,15 +179,36 @@ class ZebraBlockHeap : public BlockHeapInterface,
     CompactBlockInfo info;
   };
 
+  struct RegionInfo {
+    // The address of the region, or nullptr if it isn't reserved.
+    uint8_t* address;
+    // The number of free slabs in the region.
+    size_t free_slab_count;
+  };
+
   // Performs an allocation, and returns a pointer to the SlabInfo where the
   // allocation was made.
   SlabInfo* AllocateImpl(uint32_t bytes);
 
+  // Reserves the first unreserved region and makes its slabs available for
+  // allocations. Under lock_.
+  // @returns true on success, false if the maximum number of regions is
+  //     already reserved or if the memory couldn't be reserved.
+  bool ReserveRegion();
+
+  // Releases the regions other than the first one that don't contain any
+  // allocated or quarantined slab, as long as enough free slabs remain in the
+  // other regions. This avoids releasing and reserving a region over and over
+  // when the heap is close to full. Under lock_.
+  void ReleaseEmptyRegions();
+
   // Checks if the quarantine invariant is satisfied.
   // @returns true if the quarantine invariant is satisfied, false otherwise.
   bool QuarantineInvariantIsSatisfied();
 
-  // Gives the 0-based index of the slab containing 'address'.
+  // Gives the 0-based index of the slab containing 'address'. The slabs of
+  // region i have the indices [i * slabs_per_region_, (i + 1) *
+  // slabs_per_region_).
   // @param address address.
   // @returns The 0-based index of the slab containing 'address', or
   //     kInvalidSlab index if the address is not valid.
@@ -175,15 +222,29 @@ class ZebraBlockHeap : public BlockHeapInterface,
   // Defines an invalid slab index.
   static const size_t kInvalidSlabIndex = SIZE_MAX;
 
-  // Heap memory address.
+  // The address of the first region, which stays reserved for the lifetime
+  // of the heap.
   uint8_t* heap_address_;
 
-  // The heap size in bytes.
+  // The size of a region in bytes.
   size_t heap_size_;
 
-  // The total number of slabs.
+  // The number of slabs in a region.
+  size_t slabs_per_region_;
+
+  // The total number of slabs in the reserved regions. Under lock_.
   size_t slab_count_;
 
+  typedef std::vector<RegionInfo, HeapAllocator<RegionInfo>> RegionInfoVector;
+
+  // Holds the information related to the regions. This has one entry per
+  // region that may be reserved. Under lock_.
+  RegionInfoVector regions_;
+
+  // The number of reserved regions other than the first that have no
+  // allocated or quarantined slab. Under lock_.
+  size_t empty_region_count_;
+
   // The ratio [0 .. 1] of the memory used by the quarantine. Under lock_.
   float quarantine_ratio_;
 
@@ -198,7 +259,8 @@ class ZebraBlockHeap : public BlockHeapInterface,
   typedef std::vector<SlabInfo,
                       HeapAllocator<SlabInfo>> SlabInfoVector;
 
-  // Holds the information related to slabs. Under lock_.
+  // Holds the information related to slabs. This covers the slabs of every
+  // region that has been reserved at some point. Under lock_.
   SlabInfoVector slab_info_;
 
   // The interface that will be notified of internal memory use. Has its own
@@ -62,6 +62,14 @@ class TestZebraBlockHeap : public ZebraBlockHeap {
   explicit TestZebraBlockHeap(MemoryNotifierInterface* memory_notifier)
       : ZebraBlockHeap(kInitialHeapSize, memory_notifier, &dummy_heap) { }
 
+  // Creates a test heap that may grow up to @p max_region_count regions of
+  // @p region_size bytes.
+  TestZebraBlockHeap(size_t region_size,
+                     size_t max_region_count,
+                     MemoryNotifierInterface* memory_notifier)
+      : ZebraBlockHeap(region_size, max_region_count, memory_notifier,
+                       &dummy_heap) { }
+
   // Allows to know if the heap can handle more allocations.
   // @returns true if the heap is full (no more allocations allowed),
   // false otherwise.
@@ -464,6 +472,83 @@ TEST(ZebraBlockHeapTest, MemoryNotifierIsCalled) {
   h.Allocate(10);
 }
 
+TEST(ZebraBlockHeapTest, GrowsAndReleasesRegions) {
+  static const size_t kSlabsPerRegion = 16;
+  TestZebraBlockHeap h(kSlabsPerRegion * ZebraBlockHeap::kSlabSize, 3,
+                       &null_notifier);
+  EXPECT_EQ(3u, h.max_region_count());
+  EXPECT_EQ(1u, h.GetRegionCount());
+  EXPECT_EQ(kSlabsPerRegion, h.slab_count_);
+
+  // Fill the first region.
+  std::vector<uint8_t*> buffers;
+  for (size_t i = 0; i < kSlabsPerRegion; ++i) {
+    uint8_t* alloc = reinterpret_cast<uint8_t*>(h.Allocate(0xFF));
+    EXPECT_NE(reinterpret_cast<uint8_t*>(NULL), alloc);
+    buffers.push_back(alloc);
+  }
+  EXPECT_EQ(1u, h.GetRegionCount());
+
+  // The next allocations reserve new regions, until the maximum is reached.
+  for (size_t i = 0; i < 2 * kSlabsPerRegion; ++i) {
+    uint8_t* alloc = reinterpret_cast<uint8_t*>(h.Allocate(0xFF));
+    EXPECT_NE(reinterpret_cast<uint8_t*>(NULL), alloc);
+    EXPECT_TRUE(IsAligned(alloc, kShadowRatio));
+    EXPECT_TRUE(alloc < h.heap_address_ ||
+                alloc >= h.heap_address_ + kSlabsPerRegion *
+                    ZebraBlockHeap::kSlabSize);
+    EXPECT_TRUE(h.IsAllocated(alloc));
+    EXPECT_EQ(0xFFu, h.GetAllocationSize(alloc));
+    buffers.push_back(alloc);
+  }
+  EXPECT_EQ(3u, h.GetRegionCount());
+  EXPECT_EQ(3 * kSlabsPerRegion, h.slab_count_);
+  EXPECT_EQ(reinterpret_cast<void*>(NULL), h.Allocate(0xFF));
+
+  // The additional regions are kept while the first region is full, even
+  // once they are empty.
+  for (size_t i = kSlabsPerRegion; i < buffers.size(); ++i)
+    EXPECT_TRUE(h.Free(buffers[i]));
+  EXPECT_EQ(3u, h.GetRegionCount());
+
+  // Freeing a few slabs of the first region allows them to be released.
+  for (size_t i = 0; i < kSlabsPerRegion / 4; ++i)
+    EXPECT_TRUE(h.Free(buffers[i]));
+  EXPECT_EQ(1u, h.GetRegionCount());
+  EXPECT_EQ(kSlabsPerRegion, h.slab_count_);
+  for (size_t i = kSlabsPerRegion; i < buffers.size(); ++i)
+    EXPECT_FALSE(h.IsAllocated(buffers[i]));
+
+  // The remaining blocks are still valid.
+  for (size_t i = kSlabsPerRegion / 4; i < kSlabsPerRegion; ++i) {
+    EXPECT_TRUE(h.IsAllocated(buffers[i]));
+    EXPECT_TRUE(h.Free(buffers[i]));
+  }
+}
+
+TEST(ZebraBlockHeapTest, MemoryNotifierIsCalledForEachRegion) {
+  testing::MockMemoryNotifier mock_notifier;
+  static const size_t kSlabsPerRegion = 4;
+
+  // Should be called when reserving the first and the additional region.
+  EXPECT_CALL(mock_notifier, NotifyFutureHeapUse(NotNull(),
+      kSlabsPerRegion * ZebraBlockHeap::kSlabSize)).Times(2);
+  // Should be called when releasing the additional region, and in the
+  // ZebraBlockHeap destructor.
+  EXPECT_CALL(mock_notifier, NotifyReturnedToOS(NotNull(),
+      kSlabsPerRegion * ZebraBlockHeap::kSlabSize)).Times(2);
+
+  TestZebraBlockHeap h(kSlabsPerRegion * ZebraBlockHeap::kSlabSize, 2,
+                       &mock_notifier);
+  std::vector<void*> buffers;
+  for (size_t i = 0; i < kSlabsPerRegion + 1; ++i)
+    buffers.push_back(h.Allocate(10));
+  EXPECT_EQ(2u, h.GetRegionCount());
+  for (size_t i = 0; i < buffers.size(); ++i)
+    EXPECT_TRUE(h.Free(buffers[i]));
+  EXPECT_EQ(1u, h.GetRegionCount());
+}
+
 TEST(ZebraBlockHeapTest, Lock) {
   TestZebraBlockHeap h;
 
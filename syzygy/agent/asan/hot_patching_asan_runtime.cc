@@ -16,6 +16,9 @@
 
 #include "base/command_line.h"
 #include "base/environment.h"
+#include "base/files/file_path.h"
+#include "base/strings/string_split.h"
+#include "base/strings/string_util.h"
 #include "base/strings/utf_string_conversions.h"
 #include "syzygy/agent/asan/logger.h"
 #include "syzygy/trace/client/client_utils.h"
@@ -24,32 +27,163 @@
 namespace agent {
 namespace asan {
 
-HotPatchingAsanRuntime::HotPatchingAsanRuntime() { }
+const char kSyzyAsanHpModulesEnvVar[] = "SYZYGY_ASAN_HP_MODULES";
+
+namespace {
+
+// @returns the lowercase base name of @p module, or an empty string on
+//     failure.
+std::wstring GetModuleBaseName(HMODULE module) {
+  wchar_t path[MAX_PATH] = {};
+  DWORD length = ::GetModuleFileName(module, path, arraysize(path));
+  if (length == 0 || length == arraysize(path))
+    return std::wstring();
+  return base::ToLowerASCII(
+      base::FilePath(base::FilePath::StringType(path, length))
+          .BaseName().value());
+}
+
+}  // namespace
+
+HotPatchingAsanRuntime::HotPatchingAsanRuntime()
+    : activated_(0), activation_policy_(kActivateAllModules) {
+}
 
 HotPatchingAsanRuntime::~HotPatchingAsanRuntime() { }
 
 bool HotPatchingAsanRuntime::HotPatch(HINSTANCE instance) {
-  logger_->Write("HPSyzyAsan: Started hot patching. Module: " +
+  EnsureActivated(true);
+
+  base::AutoLock auto_lock(lock_);
+  return HotPatchUnlocked(instance);
+}
+
+void HotPatchingAsanRuntime::SetUp() {
+  // Only the activation policy is set up here. A module list in the
+  // environment restricts the activation to the modules it names.
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  std::string modules;
+  if (env.get() != nullptr && env->GetVar(kSyzyAsanHpModulesEnvVar, &modules)) {
+    set_activation_policy(kActivateSelectedModules);
+    for (const std::string& module : base::SplitString(
+             modules, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+      AddModuleToActivate(base::UTF8ToWide(module));
+    }
+  }
+}
+
+void HotPatchingAsanRuntime::OnModuleLoaded(HINSTANCE instance) {
+  {
+    base::AutoLock auto_lock(lock_);
+    if (hot_patched_modules_.count(instance))
+      return;
+    if (!ShouldActivateModuleUnlocked(instance)) {
+      inactive_modules_.insert(instance);
+      return;
+    }
+  }
+
+  // This runs under the loader lock, so it mustn't wait for another thread
+  // that is setting up the runtime. The module is then patched without
+  // logging.
+  EnsureActivated(false);
+
+  base::AutoLock auto_lock(lock_);
+  HotPatchUnlocked(instance);
+}
+
+void HotPatchingAsanRuntime::OnModuleUnloaded(HINSTANCE instance) {
+  base::AutoLock auto_lock(lock_);
+  hot_patched_modules_.erase(instance);
+  inactive_modules_.erase(instance);
+}
+
+bool HotPatchingAsanRuntime::ActivateModule(HINSTANCE instance) {
+  {
+    base::AutoLock auto_lock(lock_);
+    if (hot_patched_modules_.count(instance))
+      return true;
+    if (!inactive_modules_.count(instance))
+      return false;
+  }
+
+  EnsureActivated(true);
+
+  // The module may have been activated or unloaded in the meantime.
+  base::AutoLock auto_lock(lock_);
+  if (hot_patched_modules_.count(instance))
+    return true;
+  if (!inactive_modules_.count(instance))
+    return false;
+  return HotPatchUnlocked(instance);
+}
+
+void HotPatchingAsanRuntime::set_activation_policy(
+    ActivationPolicy activation_policy) {
+  base::AutoLock auto_lock(lock_);
+  activation_policy_ = activation_policy;
+}
+
+void HotPatchingAsanRuntime::AddModuleToActivate(
+    const base::StringPiece16& module_name) {
+  base::AutoLock auto_lock(lock_);
+  modules_to_activate_.insert(base::ToLowerASCII(module_name));
+}
+
+bool HotPatchingAsanRuntime::EnsureActivated(bool may_block) {
+  if (base::subtle::Acquire_Load(&activated_) != 0)
+    return true;
+
+  if (may_block) {
+    activation_lock_.Acquire();
+  } else if (!activation_lock_.Try()) {
+    return false;
+  }
+
+  if (base::subtle::NoBarrier_Load(&activated_) == 0) {
+    SetUpLogger();
+    logger_->Write("HPSyzyAsan: Runtime activated.");
+    base::subtle::Release_Store(&activated_, 1);
+  }
+
+  activation_lock_.Release();
+  return true;
+}
+
+void HotPatchingAsanRuntime::Log(const std::string& message) {
+  if (base::subtle::Acquire_Load(&activated_) != 0)
+    logger_->Write(message);
+}
+
+bool HotPatchingAsanRuntime::HotPatchUnlocked(HINSTANCE instance) {
+  lock_.AssertAcquired();
+
+  Log("HPSyzyAsan: Started hot patching. Module: " +
       std::to_string(reinterpret_cast<int>(instance)) +
       " PID: " +
       std::to_string(GetCurrentProcessId()));
 
   if (hot_patched_modules_.count(instance)) {
-    logger_->Write("HPSyzyAsan - Already tried to hot patch, exiting.");
+    Log("HPSyzyAsan - Already tried to hot patch, exiting.");
     return true;
   }
   hot_patched_modules_.insert(instance);
+  inactive_modules_.erase(instance);
 
   // TODO(cseri): Do the hot patching.
-  logger_->Write("HPSyzyAsan: Hot patching not yet implemented.");
+  Log("HPSyzyAsan: Hot patching not yet implemented.");
 
   return true;
 }
 
-void HotPatchingAsanRuntime::SetUp() {
-  SetUpLogger();
+bool HotPatchingAsanRuntime::ShouldActivateModuleUnlocked(HINSTANCE instance) {
+  lock_.AssertAcquired();
 
-  logger_->Write("HPSyzyAsan: Runtime loaded.");
+  if (activation_policy_ == kActivateAllModules)
+    return true;
+
+  DCHECK_EQ(kActivateSelectedModules, activation_policy_);
+  return modules_to_activate_.count(GetModuleBaseName(instance)) != 0;
 }
 
 void HotPatchingAsanRuntime::SetUpLogger() {
@@ -76,7 +210,7 @@ void WINAPI HotPatchingAsanRuntime::DllMainEntryHook(
 
   switch (reason) {
     case DLL_PROCESS_ATTACH: {
-      HotPatchingAsanRuntime::GetInstance()->HotPatch(instance);
+      HotPatchingAsanRuntime::GetInstance()->OnModuleLoaded(instance);
       break;
     }
 
@@ -88,9 +222,12 @@ void WINAPI HotPatchingAsanRuntime::DllMainEntryHook(
       // Nothing to do here.
       break;
 
-    case DLL_PROCESS_DETACH:
-      // Nothing to do here.
+    case DLL_PROCESS_DETACH: {
+      // Forget about the module, as another one may later be loaded at the
+      // same address.
+      HotPatchingAsanRuntime::GetInstance()->OnModuleUnloaded(instance);
       break;
+    }
 
     default:
       NOTREACHED();
@@ -107,4 +244,12 @@ agent::asan::HotPatchingAsanRuntime* hp_asan_GetActiveHotPatchingAsanRuntime() {
   return agent::asan::HotPatchingAsanRuntime::GetInstance();
 }
 
+BOOL WINAPI hp_asan_ActivateModule(HMODULE module) {
+  if (!agent::asan::HotPatchingAsanRuntime::GetInstance()->ActivateModule(
+          module)) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
 }
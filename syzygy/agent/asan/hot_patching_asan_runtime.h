@@ -23,11 +23,15 @@
 
 #include <windows.h>
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_set>
 
+#include "base/atomicops.h"
 #include "base/logging.h"
 #include "base/memory/singleton.h"
+#include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/agent/common/entry_frame.h"
 
 namespace agent {
@@ -35,6 +39,11 @@ namespace asan {
 
 class AsanLogger;
 
+// The name of the environment variable holding the comma separated list of
+// the base names of the modules to activate as soon as they are loaded. When
+// it is set, the other modules are only activated on request.
+extern const char kSyzyAsanHpModulesEnvVar[];
+
 class HotPatchingAsanRuntime {
  public:
   // Hot patching Asan transform instruments the entry point of the modules so
@@ -52,22 +61,65 @@ class HotPatchingAsanRuntime {
     return base::Singleton<HotPatchingAsanRuntime>::get();
   }
 
+  // The policies deciding which of the instrumented modules are activated
+  // when they are loaded.
+  enum ActivationPolicy {
+    // Every instrumented module is activated.
+    kActivateAllModules,
+    // Only the modules selected via AddModuleToActivate are activated when
+    // loaded. The others are activated on request, via ActivateModule.
+    kActivateSelectedModules,
+  };
+
   // Activates the hot patching Asan mode on a given module.
   // @param instance The handle to the module.
-  // NOTE: The current implementation of this function is not thread-safe. This
-  //     is not a problem for now, because we call this function under the
-  //     loader lock.
   bool HotPatch(HINSTANCE instance);
 
-  // Sets up the hot patching Asan runtime.
+  // Sets up the hot patching Asan runtime. This only reads the activation
+  // policy; the rest of the runtime is set up when the first module gets
+  // activated, so that processes without any active module don't pay for it.
   void SetUp();
 
+  // Notifies the runtime that an instrumented module is being loaded. The
+  // module is activated right away if the activation policy selects it, and
+  // is otherwise left inactive until ActivateModule is called.
+  // @param instance The handle to the module.
+  void OnModuleLoaded(HINSTANCE instance);
+
+  // Notifies the runtime that an instrumented module is being unloaded.
+  // @param instance The handle to the module.
+  void OnModuleUnloaded(HINSTANCE instance);
+
+  // Activates an instrumented module, regardless of the activation policy.
+  // @param instance The handle to the module.
+  // @returns true on success, false if the module isn't instrumented.
+  bool ActivateModule(HINSTANCE instance);
+
+  // @name Accessors to the activation policy.
+  // @{
+  ActivationPolicy activation_policy() const { return activation_policy_; }
+  void set_activation_policy(ActivationPolicy activation_policy);
+  // @}
+
+  // Selects a module to be activated when loaded under the
+  // kActivateSelectedModules policy.
+  // @param module_name The base name of the module, e.g. "foo.dll". This is
+  //     case insensitive.
+  void AddModuleToActivate(const base::StringPiece16& module_name);
+
   // Gets the set of modules that have already been hot patched.
   // @returns a set containing the handles of the hot patched modules.
   const std::unordered_set<HMODULE>& hot_patched_modules() {
     return hot_patched_modules_;
   }
 
+  // Gets the set of instrumented modules that have been loaded but not
+  // activated.
+  // @returns a set containing the handles of the inactive modules.
+  const std::unordered_set<HMODULE>& inactive_modules() {
+    return inactive_modules_;
+  }
+
   // Gets a logger.
   AsanLogger* logger() {
     DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger_.get());
@@ -77,14 +129,53 @@ class HotPatchingAsanRuntime {
  protected:
   void SetUpLogger();
 
+  // Sets up the parts of the runtime that are deferred until the first module
+  // is activated. Must not be called under lock_, as the logger set-up may
+  // need the loader lock, which is held while lock_ is taken in DllMain.
+  // @param may_block If false, this gives up rather than waiting for another
+  //     thread that is already setting up the runtime. This must be false
+  //     under the loader lock, as the other thread may be waiting for it.
+  // @returns true if the runtime is set up, false if this gave up.
+  bool EnsureActivated(bool may_block);
+
+  // Writes @p message to the logger, if it's set up.
+  // @param message The message to write.
+  void Log(const std::string& message);
+
+  // Implementation of HotPatch. Must be called under lock_.
+  bool HotPatchUnlocked(HINSTANCE instance);
+
+  // @returns true if @p instance is selected by the activation policy.
+  bool ShouldActivateModuleUnlocked(HINSTANCE instance);
+
+  // Serializes the deferred set-up of the runtime, which is done once. This
+  // is never held at the same time as lock_.
+  base::Lock activation_lock_;
+
+  // Non-zero once the deferred set-up is complete, and logger_ can be used
+  // without holding activation_lock_.
+  base::subtle::Atomic32 activated_;
+
   // The shared logger instance that will be used to report errors and runtime
-  // information.
+  // information. Set up by EnsureActivated.
   std::unique_ptr<AsanLogger> logger_;
 
+  // Protects the state below. The hot patching happens under the loader lock,
+  // but modules may be activated on request from any thread.
+  base::Lock lock_;
+
+  // The activation policy, and the lowercase base names of the modules it
+  // selects.
+  ActivationPolicy activation_policy_;
+  std::set<std::wstring> modules_to_activate_;
+
   // Set of modules that have already been hot patched. We don't want to hot
   // patch the same module twice.
   std::unordered_set<HMODULE> hot_patched_modules_;
 
+  // Set of instrumented modules that are waiting to be activated.
+  std::unordered_set<HMODULE> inactive_modules_;
+
  private:
   friend struct base::DefaultSingletonTraits<HotPatchingAsanRuntime>;
   friend class HotPatchingAsanRuntimeTest;
@@ -104,6 +195,12 @@ extern "C" {
 // @returns the runtime instance.
 agent::asan::HotPatchingAsanRuntime* hp_asan_GetActiveHotPatchingAsanRuntime();
 
+// Activates an instrumented module that was left inactive by the activation
+// policy.
+// @param module The handle to the module.
+// @returns TRUE on success, FALSE if the module isn't instrumented.
+BOOL WINAPI hp_asan_ActivateModule(HMODULE module);
+
 }
 
 #endif  // SYZYGY_AGENT_ASAN_HOT_PATCHING_ASAN_RUNTIME_H_
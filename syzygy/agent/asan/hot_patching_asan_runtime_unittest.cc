@@ -164,5 +164,41 @@ TEST_F(HotPatchingAsanRuntimeTest, TestRuntime) {
   relink_helper.TearDown();
 }
 
+#ifdef _COVERAGE_BUILD
+TEST_F(HotPatchingAsanRuntimeTest, DISABLED_TestSelectedModuleActivation) {
+#else
+TEST_F(HotPatchingAsanRuntimeTest, TestSelectedModuleActivation) {
+#endif
+  HotPatchingAsanRelinkHelper relink_helper;
+  relink_helper.SetUp();
+  relink_helper.InstrumentAndLoadTestDll();
+
+  // No module is selected, so loading the instrumented dll must leave it
+  // inactive.
+  runtime_->set_activation_policy(
+      agent::asan::HotPatchingAsanRuntime::kActivateSelectedModules);
+  relink_helper.LoadTestDll(relink_helper.hp_test_dll_path_,
+                            &relink_helper.module_);
+  EXPECT_EQ(0U, runtime_->hot_patched_modules().count(relink_helper.module_));
+  EXPECT_EQ(1U, runtime_->inactive_modules().count(relink_helper.module_));
+
+  // Explicitly activating it hot patches it.
+  EXPECT_TRUE(runtime_->ActivateModule(relink_helper.module_));
+  EXPECT_EQ(1U, runtime_->hot_patched_modules().count(relink_helper.module_));
+  EXPECT_EQ(0U, runtime_->inactive_modules().count(relink_helper.module_));
+
+  // Activating it again is a no-op.
+  EXPECT_TRUE(runtime_->ActivateModule(relink_helper.module_));
+
+  // Modules the runtime doesn't know about can't be activated.
+  EXPECT_FALSE(runtime_->ActivateModule(::GetModuleHandle(nullptr)));
+
+  runtime_->set_activation_policy(
+      agent::asan::HotPatchingAsanRuntime::kActivateAllModules);
+
+  // Ensure the relink helper is torn down.
+  relink_helper.TearDown();
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -14,11 +14,13 @@
 
 #include "syzygy/agent/asan/iat_patcher.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "base/logging.h"
 #include "base/win/iat_patch_function.h"
 #include "base/win/pe_image.h"
+#include "syzygy/agent/asan/constants.h"
 #include "syzygy/agent/asan/scoped_page_protections.h"
 #include "syzygy/common/align.h"
 #include "syzygy/common/com_utils.h"
@@ -31,7 +33,8 @@ namespace {
 using OnUnprotectCallback = ScopedPageProtections::OnUnprotectCallback;
 
 PatchResult UpdateImportThunk(volatile PIMAGE_THUNK_DATA iat,
-                              FunctionPointer function) {
+                              FunctionPointer function,
+                              uintptr_t old_fn) {
   // Writing to an IAT is inherently racy, as there may be other parties also
   // writing the same page at the same time. This gets ugly where multiple
   // parties mess with page protections, as VirtualProtect causes surprising
@@ -40,7 +43,6 @@ PatchResult UpdateImportThunk(volatile PIMAGE_THUNK_DATA iat,
   // detect races on VM operations as well as on assignment.
 
   __try {
-    uintptr_t old_fn = iat->u1.Function;
     uintptr_t new_fn = reinterpret_cast<uintptr_t>(function);
     uintptr_t prev_fn =
         ::InterlockedCompareExchange(&iat->u1.Function, new_fn, old_fn);
@@ -58,6 +60,20 @@ PatchResult UpdateImportThunk(volatile PIMAGE_THUNK_DATA iat,
   return PATCH_SUCCEEDED;
 }
 
+// Restores an import thunk to the value it had before being patched. This is
+// best effort: a thunk that has since been changed by somebody else is left
+// alone.
+void RevertImportThunk(volatile PIMAGE_THUNK_DATA iat,
+                       FunctionPointer function,
+                       uintptr_t old_fn) {
+  __try {
+    ::InterlockedCompareExchange(&iat->u1.Function, old_fn,
+                                 reinterpret_cast<uintptr_t>(function));
+  } __except(EXCEPTION_EXECUTE_HANDLER) {
+    // Nothing more can be done.
+  }
+}
+
 class IATPatchWorker {
  public:
   explicit IATPatchWorker(const IATPatchMap& patch);
@@ -69,36 +85,62 @@ class IATPatchWorker {
   }
 
  private:
+  // An import thunk to be patched.
+  struct PendingPatch {
+    PIMAGE_THUNK_DATA iat;
+    FunctionPointer function;
+    uintptr_t old_function;
+  };
+  using PendingPatches = std::vector<PendingPatch>;
+
   static bool VisitImport(const base::win::PEImage &image, LPCSTR module,
                           DWORD ordinal, LPCSTR name, DWORD hint,
                           PIMAGE_THUNK_DATA iat, PVOID cookie);
-  PatchResult OnImport(const char* name, PIMAGE_THUNK_DATA iat);
+  void OnImport(const char* name, PIMAGE_THUNK_DATA iat);
+
+  // Makes writable all the pages containing the pending patches. Thunks that
+  // are at most a page apart are unprotected together, so that an import
+  // table is typically unprotected by a single call.
+  PatchResult UnprotectPendingPatches();
+
+  // Applies all of the pending patches, or none of them.
+  PatchResult ApplyPendingPatches();
 
   ScopedPageProtections scoped_page_protections_;
   const IATPatchMap& patch_;
-  PatchResult result_;
+  PendingPatches pending_patches_;
 
   DISALLOW_COPY_AND_ASSIGN(IATPatchWorker);
 };
 
-IATPatchWorker::IATPatchWorker(const IATPatchMap& patch)
-    : patch_(patch), result_(PATCH_SUCCEEDED) {
+IATPatchWorker::IATPatchWorker(const IATPatchMap& patch) : patch_(patch) {
 }
 
 PatchResult IATPatchWorker::PatchImage(base::win::PEImage* image) {
   DCHECK_NE(static_cast<base::win::PEImage*>(nullptr), image);
 
-  // This is actually '0', so ORing error conditions to it is just fine.
-  result_ = PATCH_SUCCEEDED;
-
-  // The IAT patching takes place during enumeration.
+  // Gather the thunks to patch first, so that the page protections are only
+  // modified once for the whole image.
+  pending_patches_.clear();
   image->EnumAllImports(&VisitImport, this);
+  if (pending_patches_.empty())
+    return PATCH_SUCCEEDED;
+
+  std::sort(pending_patches_.begin(), pending_patches_.end(),
+            [](const PendingPatch& patch1, const PendingPatch& patch2) {
+              return patch1.iat < patch2.iat;
+            });
+
+  // This is actually '0', so ORing error conditions to it is just fine.
+  PatchResult result = UnprotectPendingPatches();
+  if (result == PATCH_SUCCEEDED)
+    result = ApplyPendingPatches();
 
   // Clean up whatever we soiled, success or failure be damned.
   if (!scoped_page_protections_.RestorePageProtections())
-    result_ |= PATCH_FAILED_REPROTECT_FAILED;
+    result |= PATCH_FAILED_REPROTECT_FAILED;
 
-  return result_;
+  return result;
 }
 
 bool IATPatchWorker::VisitImport(
@@ -108,28 +150,69 @@ bool IATPatchWorker::VisitImport(
     return true;
 
   IATPatchWorker* worker = reinterpret_cast<IATPatchWorker*>(cookie);
-  PatchResult result = worker->OnImport(name, iat);
-  if (result == PATCH_SUCCEEDED)
-    return true;
-
-  // Remember the reason for failure.
-  worker->result_ |= result;
-  return false;
+  worker->OnImport(name, iat);
+  return true;
 }
 
-PatchResult IATPatchWorker::OnImport(const char* name, PIMAGE_THUNK_DATA iat) {
+void IATPatchWorker::OnImport(const char* name, PIMAGE_THUNK_DATA iat) {
   auto it = patch_.find(name);
   // See whether this is a function we care about.
   if (it == patch_.end())
-    return PATCH_SUCCEEDED;
+    return;
+
+  PendingPatch patch = { iat, it->second, iat->u1.Function };
+  pending_patches_.push_back(patch);
+}
 
-  // Make the containing page writable.
-  if (!scoped_page_protections_.EnsureContainingPagesWritable(
-          iat, sizeof(IMAGE_THUNK_DATA))) {
-    return PATCH_FAILED_UNPROTECT_FAILED;
+PatchResult IATPatchWorker::UnprotectPendingPatches() {
+  DCHECK(!pending_patches_.empty());
+
+  auto run_begin = pending_patches_.begin();
+  while (run_begin != pending_patches_.end()) {
+    auto run_last = run_begin;
+    auto run_end = run_begin + 1;
+    while (run_end != pending_patches_.end() &&
+           reinterpret_cast<uint8_t*>(run_end->iat) -
+                   reinterpret_cast<uint8_t*>(run_last->iat) <=
+               static_cast<ptrdiff_t>(GetPageSize())) {
+      run_last = run_end;
+      ++run_end;
+    }
+
+    uint8_t* begin = reinterpret_cast<uint8_t*>(run_begin->iat);
+    uint8_t* end = reinterpret_cast<uint8_t*>(run_last->iat + 1);
+    if (!scoped_page_protections_.EnsureContainingPagesWritable(
+            begin, end - begin)) {
+      return PATCH_FAILED_UNPROTECT_FAILED;
+    }
+
+    run_begin = run_end;
   }
 
-  return UpdateImportThunk(iat, it->second);
+  return PATCH_SUCCEEDED;
+}
+
+PatchResult IATPatchWorker::ApplyPendingPatches() {
+  DCHECK(!pending_patches_.empty());
+
+  for (size_t i = 0; i < pending_patches_.size(); ++i) {
+    const PendingPatch& patch = pending_patches_[i];
+    PatchResult result = UpdateImportThunk(patch.iat, patch.function,
+                                           patch.old_function);
+    if (result == PATCH_SUCCEEDED)
+      continue;
+
+    // Undo the patches applied so far, so that the module isn't left half
+    // patched.
+    while (i > 0) {
+      --i;
+      RevertImportThunk(pending_patches_[i].iat, pending_patches_[i].function,
+                        pending_patches_[i].old_function);
+    }
+    return result;
+  }
+
+  return PATCH_SUCCEEDED;
 }
 
 }  // namespace
@@ -57,7 +57,10 @@ using IATPatchMap = std::map<base::StringPiece, FunctionPointer>;
 // Testing callback.
 
 // Modifies the IAT of @p module such that each function named in @p patch_map
-// points to the associated function.
+// points to the associated function. All the thunks of the module are patched
+// in one pass, during which each run of IAT pages is unprotected once. If any
+// thunk fails to be patched then those already patched are reverted, so the
+// module is never left half patched.
 // @param module the module to patch up.
 // @param patch_map a map from name to the desired function.
 // @param on_unprotect Callback function that is invoked as page protections
@@ -167,5 +167,20 @@ TEST_F(IATPatcherTest, FailsWithAccessViolation) {
   EXPECT_EQ(iat_before, iat_after);
 }
 
+TEST_F(IATPatcherTest, UnprotectsOnlyWhenPatching) {
+  IATPatchMap patches;
+  patches["no_such_function"] = PatchDestination;
+
+  ScopedPageProtections::OnUnprotectCallback on_unprotect =
+      base::Bind(&IATPatcherTest::OnUnprotect, base::Unretained(this));
+
+  // Nothing matches, so no page protection should be touched. The strict mock
+  // fails the test on any call.
+  ImportTable iat_before = GetIAT(test_dll_);
+  EXPECT_EQ(PATCH_SUCCEEDED,
+            PatchIATForModule(test_dll_, patches, on_unprotect));
+  EXPECT_EQ(iat_before, GetIAT(test_dll_));
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -0,0 +1,137 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A bounded circular queue that can be pushed to and popped from by several
+// threads without locking.
+// This offers the interface of CircularQueue, and like it reserves its memory
+// only once. Each slot of the queue carries a sequence number, which tells
+// the producers and the consumers whose turn it is to use the slot. Claiming
+// a slot is a single compare-and-swap of the tail or head position, so
+// threads only ever contend on that, and never wait for each other.
+// The capacity is rounded up to a power of two.
+//
+// Any number of threads may push concurrently. Any number of threads may pop
+// concurrently with pop(T*), which copies the element out of the queue as
+// it's removed. front() and pop() are only safe with a single consumer, as
+// another consumer could remove the element between the two calls.
+//
+// USAGE:
+// LockFreeCircularQueue<int, MemoryNotifierAllocator<int>> q(
+//     capacity, MemoryNotifierAllocator<int>(&notifier));
+// LockFreeCircularQueue<int> q(capacity);  // Using the default allocator.
+
+#ifndef SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_H_
+#define SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_H_
+
+#include <memory>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/macros.h"
+
+namespace agent {
+namespace asan {
+
+// A bounded lock-free circular queue.
+// @tparam T the type of the elements. This must be copyable.
+// @tparam Alloc the type of the allocator used by the underlying container.
+template<typename T, typename Alloc = std::allocator<T>>
+class LockFreeCircularQueue {
+ public:
+  // Constructor.
+  // @param max_capacity Minimum number of elements the queue can store.
+  explicit LockFreeCircularQueue(size_t max_capacity);
+
+  // Constructor.
+  // @param max_capacity Minimum number of elements the queue can store.
+  // @param alloc The allocator to use with this container.
+  LockFreeCircularQueue(size_t max_capacity, const Alloc& alloc);
+
+  // Inserts an element in the back/tail of the queue if possible.
+  // @param elem the element to be inserted.
+  // @returns true if the operation succeeded and the element was inserted,
+  //     false if the queue is full.
+  bool push(const T& elem);
+
+  // Removes an element from the front/head of the queue if possible.
+  // @returns true if an element was popped from the front/head,
+  //     false if the queue is empty.
+  // @note Only safe with a single consumer.
+  bool pop();
+
+  // Removes an element from the front/head of the queue if possible.
+  // @param elem Will receive the removed element. May be nullptr.
+  // @returns true if an element was popped from the front/head,
+  //     false if the queue is empty.
+  bool pop(T* elem);
+
+  // @returns the element in the front/head of the queue.
+  // @note Only safe with a single consumer.
+  const T& front() const;
+
+  // Gives the current number of elements in the queue. This is only a
+  // snapshot when other threads are using the queue.
+  // @returns the number of elements currently stored in the queue.
+  size_t size() const;
+
+  // Tests if the queue is empty.
+  // @returns true if the queue is empty, false otherwise.
+  bool empty() const;
+
+  // @returns the maximum number of elements the queue can handle.
+  size_t max_capacity() const;
+
+ private:
+  // A slot of the queue. A slot at index i is free for the push at position
+  // p when its sequence is p, and holds the element to pop at position p when
+  // its sequence is p + 1. Popping it then makes it free for the push at
+  // position p + max_capacity().
+  struct Cell {
+    base::subtle::AtomicWord sequence;
+    T element;
+  };
+  typedef typename Alloc::template rebind<Cell>::other CellAlloc;
+  typedef std::vector<Cell, CellAlloc> Container;
+
+  // @returns the difference between a sequence number and a position.
+  static intptr_t Distance(base::subtle::AtomicWord sequence,
+                           base::subtle::AtomicWord position);
+
+  // Initializes the slots of the queue.
+  // @param max_capacity The requested capacity.
+  void Init(size_t max_capacity);
+
+  // The queue underlying container, and the mask giving the index of a
+  // position in it.
+  Container buffer_;
+  size_t mask_;
+
+  // The position of the next element to pop. This is padded to a cache line
+  // to avoid false sharing between the producers and the consumers.
+  base::subtle::AtomicWord head_;
+  uint8_t head_padding_[64 - sizeof(base::subtle::AtomicWord)];
+
+  // The position of the next element to push.
+  base::subtle::AtomicWord tail_;
+  uint8_t tail_padding_[64 - sizeof(base::subtle::AtomicWord)];
+
+  DISALLOW_COPY_AND_ASSIGN(LockFreeCircularQueue);
+};
+
+}  // namespace asan
+}  // namespace agent
+
+#include "syzygy/agent/asan/lock_free_circular_queue_impl.h"
+
+#endif  // SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_H_
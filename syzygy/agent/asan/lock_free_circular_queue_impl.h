@@ -0,0 +1,169 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation details for lock_free_circular_queue.h. Not meant
+// to be included directly.
+
+#ifndef SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_IMPL_H_
+#define SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_IMPL_H_
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace agent {
+namespace asan {
+
+template<typename T, typename Alloc>
+LockFreeCircularQueue<T, Alloc>::LockFreeCircularQueue(size_t max_capacity)
+    : mask_(0u), head_(0), tail_(0) {
+  Init(max_capacity);
+}
+
+template<typename T, typename Alloc>
+LockFreeCircularQueue<T, Alloc>::LockFreeCircularQueue(
+    size_t max_capacity, const Alloc& alloc)
+    : buffer_(CellAlloc(alloc)),
+      mask_(0u),
+      head_(0),
+      tail_(0) {
+  Init(max_capacity);
+}
+
+template<typename T, typename Alloc>
+bool LockFreeCircularQueue<T, Alloc>::push(const T& elem) {
+  base::subtle::AtomicWord position = base::subtle::NoBarrier_Load(&tail_);
+  Cell* cell = nullptr;
+  while (true) {
+    cell = &buffer_[position & mask_];
+    intptr_t distance =
+        Distance(base::subtle::Acquire_Load(&cell->sequence), position);
+    if (distance == 0) {
+      // The slot is free, try to claim it.
+      base::subtle::AtomicWord previous =
+          base::subtle::NoBarrier_CompareAndSwap(&tail_, position,
+                                                 position + 1);
+      if (previous == position)
+        break;
+      position = previous;
+    } else if (distance < 0) {
+      // The slot still holds the element pushed one lap ago.
+      return false;
+    } else {
+      // Another producer claimed the slot, catch up.
+      position = base::subtle::NoBarrier_Load(&tail_);
+    }
+  }
+
+  cell->element = elem;
+  base::subtle::Release_Store(&cell->sequence, position + 1);
+  return true;
+}
+
+template<typename T, typename Alloc>
+bool LockFreeCircularQueue<T, Alloc>::pop() {
+  return pop(nullptr);
+}
+
+template<typename T, typename Alloc>
+bool LockFreeCircularQueue<T, Alloc>::pop(T* elem) {
+  base::subtle::AtomicWord position = base::subtle::NoBarrier_Load(&head_);
+  Cell* cell = nullptr;
+  while (true) {
+    cell = &buffer_[position & mask_];
+    intptr_t distance =
+        Distance(base::subtle::Acquire_Load(&cell->sequence), position + 1);
+    if (distance == 0) {
+      // The slot holds an element, try to claim it.
+      base::subtle::AtomicWord previous =
+          base::subtle::NoBarrier_CompareAndSwap(&head_, position,
+                                                 position + 1);
+      if (previous == position)
+        break;
+      position = previous;
+    } else if (distance < 0) {
+      // The slot hasn't been pushed to yet.
+      return false;
+    } else {
+      // Another consumer claimed the slot, catch up.
+      position = base::subtle::NoBarrier_Load(&head_);
+    }
+  }
+
+  if (elem != nullptr)
+    *elem = cell->element;
+  base::subtle::Release_Store(&cell->sequence, position + mask_ + 1);
+  return true;
+}
+
+template<typename T, typename Alloc>
+const T& LockFreeCircularQueue<T, Alloc>::front() const {
+  DCHECK(!empty());
+  base::subtle::AtomicWord position = base::subtle::NoBarrier_Load(&head_);
+  const Cell& cell = buffer_[position & mask_];
+  DCHECK_EQ(0, Distance(base::subtle::Acquire_Load(&cell.sequence),
+                        position + 1));
+  return cell.element;
+}
+
+template<typename T, typename Alloc>
+size_t LockFreeCircularQueue<T, Alloc>::size() const {
+  // Read the head first, so that the difference can't be negative.
+  base::subtle::AtomicWord head = base::subtle::Acquire_Load(&head_);
+  base::subtle::AtomicWord tail = base::subtle::Acquire_Load(&tail_);
+  size_t size = static_cast<size_t>(Distance(tail, head));
+  return std::min(size, max_capacity());
+}
+
+template<typename T, typename Alloc>
+bool LockFreeCircularQueue<T, Alloc>::empty() const {
+  return size() == 0;
+}
+
+template<typename T, typename Alloc>
+size_t LockFreeCircularQueue<T, Alloc>::max_capacity() const {
+  return buffer_.size();
+}
+
+// static
+template<typename T, typename Alloc>
+intptr_t LockFreeCircularQueue<T, Alloc>::Distance(
+    base::subtle::AtomicWord sequence,
+    base::subtle::AtomicWord position) {
+  // Positions eventually wrap around, so this is computed modulo the word
+  // size.
+  return static_cast<intptr_t>(static_cast<uintptr_t>(sequence) -
+                               static_cast<uintptr_t>(position));
+}
+
+template<typename T, typename Alloc>
+void LockFreeCircularQueue<T, Alloc>::Init(size_t max_capacity) {
+  DCHECK_LT(0u, max_capacity);
+
+  // The positions are mapped to slots with a mask, which keeps the mapping
+  // continuous when the positions wrap around.
+  size_t capacity = 1;
+  while (capacity < max_capacity)
+    capacity <<= 1;
+  mask_ = capacity - 1;
+
+  buffer_.resize(capacity);
+  for (size_t i = 0; i < capacity; ++i)
+    buffer_[i].sequence = static_cast<base::subtle::AtomicWord>(i);
+}
+
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_LOCK_FREE_CIRCULAR_QUEUE_IMPL_H_
@@ -0,0 +1,220 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/lock_free_circular_queue.h"
+
+#include <memory>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/allocators.h"
+#include "syzygy/agent/asan/unittest_util.h"
+
+namespace agent {
+namespace asan {
+
+namespace {
+
+using testing::MockMemoryNotifier;
+
+using ::testing::_;
+using ::testing::AtLeast;
+
+typedef LockFreeCircularQueue<uint32_t> TestQueue;
+
+// Pushes a range of values to a queue, retrying while it's full.
+class ProducerThread : public base::SimpleThread {
+ public:
+  ProducerThread(TestQueue* queue, uint32_t first_value, uint32_t count)
+      : base::SimpleThread("ProducerThread"),
+        queue_(queue),
+        first_value_(first_value),
+        count_(count) {
+  }
+
+  void Run() override {
+    for (uint32_t i = 0; i < count_; ++i) {
+      while (!queue_->push(first_value_ + i))
+        base::PlatformThread::YieldCurrentThread();
+    }
+  }
+
+ private:
+  TestQueue* queue_;
+  uint32_t first_value_;
+  uint32_t count_;
+};
+
+// Pops values from a queue until it has seen a given number of them overall,
+// and counts how many times each value was seen.
+class ConsumerThread : public base::SimpleThread {
+ public:
+  ConsumerThread(TestQueue* queue,
+                 volatile LONG* popped_count,
+                 LONG total_count,
+                 std::vector<LONG>* seen)
+      : base::SimpleThread("ConsumerThread"),
+        queue_(queue),
+        popped_count_(popped_count),
+        total_count_(total_count),
+        seen_(seen) {
+  }
+
+  void Run() override {
+    while (*popped_count_ < total_count_) {
+      uint32_t value = 0;
+      if (!queue_->pop(&value)) {
+        base::PlatformThread::YieldCurrentThread();
+        continue;
+      }
+      ASSERT_LT(value, seen_->size());
+      ::InterlockedIncrement(&(*seen_)[value]);
+      ::InterlockedIncrement(popped_count_);
+    }
+  }
+
+ private:
+  TestQueue* queue_;
+  volatile LONG* popped_count_;
+  LONG total_count_;
+  std::vector<LONG>* seen_;
+};
+
+}  // namespace
+
+TEST(LockFreeCircularQueue, MaxCapacity) {
+  TestQueue q(128);
+  EXPECT_EQ(128u, q.max_capacity());
+
+  // The capacity is rounded up to a power of two.
+  TestQueue q2(100);
+  EXPECT_EQ(128u, q2.max_capacity());
+}
+
+TEST(LockFreeCircularQueue, ComplyWithFIFO) {
+  size_t capacity = 128;
+  TestQueue q(capacity);
+
+  uint32_t initial = 10;
+  for (uint32_t i = 0; i < initial; ++i)
+    EXPECT_TRUE(q.push(i));
+
+  for (uint32_t i = initial; i < 1000 * capacity; ++i) {
+    EXPECT_TRUE(q.push(i));
+    EXPECT_EQ(initial + 1, q.size());
+    EXPECT_EQ(i - initial, q.front());
+    if (i % 2) {
+      EXPECT_TRUE(q.pop());
+    } else {
+      uint32_t value = 0;
+      EXPECT_TRUE(q.pop(&value));
+      EXPECT_EQ(i - initial, value);
+    }
+  }
+}
+
+TEST(LockFreeCircularQueue, PushWhenFull) {
+  size_t capacity = 128;
+  TestQueue q(capacity);
+
+  for (uint32_t i = 0; i < capacity; ++i) {
+    EXPECT_TRUE(q.push(i));
+    EXPECT_FALSE(q.empty());
+  }
+  EXPECT_EQ(capacity, q.size());
+
+  EXPECT_FALSE(q.push(1));
+  EXPECT_EQ(capacity, q.size());
+
+  // Popping frees a slot.
+  EXPECT_TRUE(q.pop());
+  EXPECT_TRUE(q.push(1));
+  EXPECT_FALSE(q.push(2));
+}
+
+TEST(LockFreeCircularQueue, PopWhenEmpty) {
+  TestQueue q(128);
+  uint32_t value = 0;
+  EXPECT_TRUE(q.empty());
+  EXPECT_FALSE(q.pop());
+  EXPECT_FALSE(q.pop(&value));
+
+  EXPECT_TRUE(q.push(42));
+  EXPECT_TRUE(q.pop(&value));
+  EXPECT_EQ(42u, value);
+  EXPECT_TRUE(q.empty());
+  EXPECT_EQ(0u, q.size());
+  EXPECT_FALSE(q.pop(&value));
+}
+
+TEST(LockFreeCircularQueue, MemoryNotifierIsCalled) {
+  MockMemoryNotifier mock_notifier;
+
+  // Should be called by the underlying container.
+  EXPECT_CALL(mock_notifier,
+    NotifyInternalUse(_, _))
+    .Times(AtLeast(1));
+
+  // Ensure no calls to NotifyFutureHeapUse.
+  EXPECT_CALL(mock_notifier,
+    NotifyFutureHeapUse(_, _))
+    .Times(0);
+
+  // Should be called by the underlying container.
+  EXPECT_CALL(mock_notifier,
+    NotifyReturnedToOS(_, _))
+    .Times(AtLeast(1));
+
+  size_t capacity = 100000;
+  LockFreeCircularQueue<int, MemoryNotifierAllocator<int>> q(
+      capacity,
+      MemoryNotifierAllocator<int>(&mock_notifier));
+}
+
+TEST(LockFreeCircularQueue, ConcurrentPushAndPop) {
+  static const size_t kProducerCount = 4;
+  static const size_t kConsumerCount = 4;
+  static const uint32_t kValuesPerProducer = 100000;
+  static const uint32_t kValueCount = kProducerCount * kValuesPerProducer;
+
+  // Use a small queue so that it's often full and often empty.
+  TestQueue q(64);
+  std::vector<LONG> seen(kValueCount, 0);
+  volatile LONG popped_count = 0;
+
+  std::vector<std::unique_ptr<base::SimpleThread>> threads;
+  for (size_t i = 0; i < kConsumerCount; ++i) {
+    threads.push_back(std::unique_ptr<base::SimpleThread>(
+        new ConsumerThread(&q, &popped_count, kValueCount, &seen)));
+  }
+  for (size_t i = 0; i < kProducerCount; ++i) {
+    threads.push_back(std::unique_ptr<base::SimpleThread>(
+        new ProducerThread(&q, i * kValuesPerProducer, kValuesPerProducer)));
+  }
+  for (auto& thread : threads)
+    thread->Start();
+  for (auto& thread : threads)
+    thread->Join();
+
+  // Every value was popped exactly once.
+  EXPECT_TRUE(q.empty());
+  EXPECT_EQ(kValueCount, popped_count);
+  for (uint32_t i = 0; i < kValueCount; ++i)
+    EXPECT_EQ(1, seen[i]);
+}
+
+}  // namespace asan
+}  // namespace agent
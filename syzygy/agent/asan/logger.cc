@@ -67,7 +67,16 @@ void InitExecutionContext(const CONTEXT& rtl_context,
 
 }  // namespace
 
-AsanLogger::AsanLogger() : log_as_text_(true), minidump_on_failure_(false) {
+AsanLogger::AsanLogger()
+    : log_as_text_(true),
+      minidump_on_failure_(false),
+      buffer_size_(0),
+      buffering_(0),
+      flush_event_(false, false) {
+}
+
+AsanLogger::~AsanLogger() {
+  StopBuffering();
 }
 
 void AsanLogger::Init() {
@@ -94,12 +103,86 @@ void AsanLogger::Init() {
 }
 
 void AsanLogger::Stop() {
+  StopBuffering();
   if (rpc_binding_.Get() != NULL) {
     ::common::rpc::InvokeRpc(&LoggerClient_Stop, rpc_binding_.Get());
   }
 }
 
+bool AsanLogger::StartBuffering() {
+  if (buffering())
+    return true;
+  if (rpc_binding_.Get() == NULL)
+    return false;
+
+  // Both buffers have room for a terminating NUL, as the RPC expects a
+  // string.
+  buffer_.reset(new char[kBufferSize + 1]);
+  flush_buffer_.reset(new char[kBufferSize + 1]);
+  buffer_size_ = 0;
+
+  base::subtle::NoBarrier_Store(&buffering_, 1);
+  // Make sure the change to |buffering_| is not reordered.
+  base::subtle::MemoryBarrier();
+  if (!base::PlatformThread::CreateWithPriority(
+          0, this, &flusher_thread_handle_,
+          base::ThreadPriority::BACKGROUND)) {
+    base::subtle::NoBarrier_Store(&buffering_, 0);
+    return false;
+  }
+
+  return true;
+}
+
+void AsanLogger::StopBuffering() {
+  if (!buffering())
+    return;
+
+  base::subtle::NoBarrier_Store(&buffering_, 0);
+  // Make sure the change to |buffering_| is not reordered.
+  base::subtle::MemoryBarrier();
+  flush_event_.Signal();
+  base::PlatformThread::Join(flusher_thread_handle_);
+
+  // Messages may have been appended while the thread was exiting.
+  Flush();
+}
+
+void AsanLogger::Flush() {
+  base::AutoLock flush_lock(flush_lock_);
+  if (flush_buffer_.get() == nullptr)
+    return;
+
+  size_t size = 0;
+  {
+    base::AutoLock buffer_lock(buffer_lock_);
+    size = buffer_size_;
+    if (size == 0)
+      return;
+    buffer_.swap(flush_buffer_);
+    buffer_size_ = 0;
+  }
+
+  // Send the whole batch in a single call.
+  flush_buffer_[size] = '\0';
+  if (rpc_binding_.Get() != NULL) {
+    ::common::rpc::InvokeRpc(
+        &LoggerClient_Write, rpc_binding_.Get(),
+        reinterpret_cast<const unsigned char*>(flush_buffer_.get()));
+  }
+}
+
 void AsanLogger::Write(const std::string& message) {
+  // Buffer the message if possible. If it doesn't fit, then send everything
+  // that's pending and try again, sending it directly as a last resort.
+  if (buffering()) {
+    if (AppendToBuffer(message))
+      return;
+    Flush();
+    if (AppendToBuffer(message))
+      return;
+  }
+
   // If we're bound to a logging endpoint, log the message there.
   if (rpc_binding_.Get() != NULL) {
     ::common::rpc::InvokeRpc(
@@ -110,6 +193,8 @@ void AsanLogger::Write(const std::string& message) {
 
 void AsanLogger::WriteWithContext(const std::string& message,
                                   const CONTEXT& context) {
+  Flush();
+
   // If we're bound to a logging endpoint, log the message there.
   if (rpc_binding_.Get() != NULL) {
     ExecutionContext exec_context = {};
@@ -123,6 +208,8 @@ void AsanLogger::WriteWithContext(const std::string& message,
 void AsanLogger::WriteWithStackTrace(const std::string& message,
                                      const void * const * trace_data,
                                      uint32_t trace_length) {
+  Flush();
+
   // If we're bound to a logging endpoint, log the message there.
   if (rpc_binding_.Get() != NULL) {
     ::common::rpc::InvokeRpc(
@@ -143,6 +230,9 @@ void AsanLogger::SaveMinidumpWithProtobufAndMemoryRanges(
   if (rpc_binding_.Get() == NULL)
     return;
 
+  // Make sure the buffered output precedes the minidump.
+  Flush();
+
   // Convert the memory ranges to arrays.
   std::vector<const void*> base_addresses;
   std::vector<size_t> range_lengths;
@@ -169,5 +259,40 @@ void AsanLogger::SaveMinidumpWithProtobufAndMemoryRanges(
       static_cast<uint32_t>(memory_ranges.size()));
 }
 
+void AsanLogger::ThreadMain() {
+  base::PlatformThread::SetName("SyzyASAN Logger Thread");
+  while (base::subtle::NoBarrier_Load(&buffering_)) {
+    flush_event_.TimedWait(
+        base::TimeDelta::FromMilliseconds(kFlushIntervalMs));
+    Flush();
+  }
+}
+
+bool AsanLogger::AppendToBuffer(const std::string& message) {
+  if (message.empty())
+    return true;
+
+  // The logger terminates each message with a newline if it lacks one. Do the
+  // same here so that batching doesn't change the output.
+  bool needs_newline = message.back() != '\n';
+  size_t size = message.size() + (needs_newline ? 1 : 0);
+
+  size_t buffer_size = 0;
+  {
+    base::AutoLock lock(buffer_lock_);
+    if (buffer_size_ + size > kBufferSize)
+      return false;
+    ::memcpy(buffer_.get() + buffer_size_, message.data(), message.size());
+    if (needs_newline)
+      buffer_[buffer_size_ + message.size()] = '\n';
+    buffer_size_ += size;
+    buffer_size = buffer_size_;
+  }
+
+  if (buffer_size >= kFlushThreshold)
+    flush_event_.Signal();
+  return true;
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -15,9 +15,14 @@
 #ifndef SYZYGY_AGENT_ASAN_LOGGER_H_
 #define SYZYGY_AGENT_ASAN_LOGGER_H_
 
+#include <memory>
 #include <string>
 
 #include "base/logging.h"
+#include "base/atomicops.h"
+#include "base/synchronization/lock.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/platform_thread.h"
 #include "syzygy/agent/asan/error_info.h"
 #include "syzygy/common/rpc/helpers.h"
 
@@ -27,9 +32,27 @@ namespace asan {
 struct AsanErrorInfo;
 
 // A wrapper class to manage the singleton Asan RPC logger instance.
-class AsanLogger {
+//
+// By default every message is sent synchronously over RPC. Once buffering has
+// been started plain messages are instead appended to an in-process buffer,
+// which a background thread periodically sends to the logger as a single
+// batch. Messages carrying a context or a stack trace, and minidump requests,
+// flush the buffer first so that the order of the output is preserved.
+class AsanLogger : public base::PlatformThread::Delegate {
  public:
+  // The size of the message buffer used when buffering, in bytes.
+  static const size_t kBufferSize = 64 * 1024;
+
+  // The amount of buffered data that causes the flusher thread to be woken
+  // up early, in bytes.
+  static const size_t kFlushThreshold = kBufferSize / 2;
+
+  // The interval at which the flusher thread sends buffered messages, in
+  // milliseconds.
+  static const uint32_t kFlushIntervalMs = 250;
+
   AsanLogger();
+  ~AsanLogger() override;
 
   // Set the RPC instance ID to use. If an instance-id is to be used by the
   // logger, it must be set before calling Init().
@@ -50,10 +73,31 @@ class AsanLogger {
   // Initialize the logger.
   void Init();
 
-  // Stop the logger.
+  // Stop the logger. This flushes any buffered messages.
   void Stop();
 
-  // Write a @p message to the logger.
+  // Starts buffering messages and launches the background thread that sends
+  // them to the logger. This is a noop if the logger isn't bound to an
+  // endpoint, or if buffering has already been started.
+  // @returns true if buffering is active, false otherwise.
+  bool StartBuffering();
+
+  // Sends all buffered messages to the logger, and stops the background
+  // thread. Subsequent messages are sent synchronously.
+  void StopBuffering();
+
+  // @returns true if messages are being buffered.
+  bool buffering() const {
+    return base::subtle::NoBarrier_Load(&buffering_) != 0;
+  }
+
+  // Synchronously sends all buffered messages to the logger. This is safe to
+  // call at any time, and must be called before crashing so that no buffered
+  // output is lost.
+  void Flush();
+
+  // Write a @p message to the logger. If buffering is active this returns as
+  // soon as the message has been copied to the buffer.
   void Write(const std::string& message);
 
   // Write a @p message to the logger, and have the logger include the most
@@ -95,6 +139,36 @@ class AsanLogger {
   bool minidump_on_failure_;
 
  private:
+  // Implementation of PlatformThread::Delegate: the flusher thread.
+  void ThreadMain() override;
+
+  // Appends a message to the buffer, waking up the flusher thread if the
+  // buffer is filling up.
+  // @param message The message to append.
+  // @returns true on success, false if the message doesn't fit.
+  bool AppendToBuffer(const std::string& message);
+
+  // The buffer receiving the messages, and the number of bytes it holds.
+  // These are under buffer_lock_, which is never held across an RPC.
+  base::Lock buffer_lock_;
+  std::unique_ptr<char[]> buffer_;
+  size_t buffer_size_;
+
+  // The buffer that is sent to the logger. Buffers are swapped by Flush, which
+  // is serialized by flush_lock_ so that batches are sent in order. Under
+  // flush_lock_.
+  base::Lock flush_lock_;
+  std::unique_ptr<char[]> flush_buffer_;
+
+  // Set while buffering is active.
+  base::subtle::Atomic32 buffering_;
+
+  // Used to wake up the flusher thread.
+  base::WaitableEvent flush_event_;
+
+  // Handle to the flusher thread.
+  base::PlatformThreadHandle flusher_thread_handle_;
+
   DISALLOW_COPY_AND_ASSIGN(AsanLogger);
 };
 
@@ -141,6 +141,57 @@ TEST_F(AsanLoggerTest, EndToEnd) {
   // TODO(rogerm): Inspect the contents of the minidump.
 }
 
+TEST_F(AsanLoggerTest, BufferedEndToEnd) {
+  const std::string kMessage1("This is the first message\n");
+  const std::string kMessage2("This is the second message");
+  std::string kLargeMessage(AsanLogger::kBufferSize, 'x');
+  kLargeMessage.push_back('\n');
+
+  {
+    // Setup a log file destination.
+    base::ScopedFILE destination(base::OpenFile(temp_path_, "wb"));
+
+    // Start up the logging service.
+    trace::agent_logger::AgentLogger server;
+    trace::agent_logger::RpcLoggerInstanceManager instance_manager(&server);
+    server.set_instance_id(instance_id_);
+    server.set_destination(destination.get());
+    ASSERT_TRUE(server.Start());
+
+    // Buffering isn't possible without an endpoint.
+    EXPECT_FALSE(client_.StartBuffering());
+    EXPECT_FALSE(client_.buffering());
+
+    client_.set_instance_id(instance_id_);
+    client_.Init();
+    ASSERT_TRUE(client_.rpc_binding_.Get() != NULL);
+    EXPECT_TRUE(client_.StartBuffering());
+    EXPECT_TRUE(client_.buffering());
+    EXPECT_TRUE(client_.StartBuffering());
+
+    // Messages are buffered, and a message that doesn't fit in the buffer is
+    // sent directly after the pending ones.
+    client_.Write(kMessage1);
+    client_.Write(kMessage2);
+    client_.Write(kLargeMessage);
+    client_.Write(kMessage1);
+
+    // Stopping flushes the remaining messages.
+    client_.StopBuffering();
+    EXPECT_FALSE(client_.buffering());
+
+    // Shutdown the logging service.
+    ASSERT_TRUE(server.Stop());
+    ASSERT_TRUE(server.Join());
+  }
+
+  // The messages made it out in order, with the missing newline added.
+  std::string content;
+  ASSERT_TRUE(base::ReadFileToString(temp_path_, &content));
+  EXPECT_THAT(content, testing::EndsWith(
+      kMessage1 + kMessage2 + "\n" + kLargeMessage + kMessage1));
+}
+
 TEST_F(AsanLoggerTest, Stop) {
   // Setup a log file destination.
   base::ScopedFILE destination(base::OpenFile(temp_path_, "wb"));
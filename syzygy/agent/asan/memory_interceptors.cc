@@ -108,6 +108,18 @@ const MemoryAccessorVariants kMemoryAccessorVariants[] = {
         ASAN_STRING_INTERCEPT_FUNCTIONS(ENUM_STRING_INTERCEPT_FUNCTION_VARIANTS)
 
 #undef ENUM_STRING_INTERCEPT_FUNCTION_VARIANTS
+
+#define ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS(access_mode_str, access_mode) \
+  { "asan_check_range_" #access_mode_str,                                  \
+    asan_redirect_range_##access_mode_str,                                 \
+    asan_range_no_check,                                                   \
+    asan_check_range_##access_mode_str,                                    \
+    asan_check_range_##access_mode_str,                                    \
+  },
+
+    ASAN_RANGE_INTERCEPT_FUNCTIONS(ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS)
+
+#undef ENUM_RANGE_INTERCEPT_FUNCTION_VARIANTS
 };
 
 const size_t kNumMemoryAccessorVariants = arraysize(kMemoryAccessorVariants);
@@ -236,6 +248,27 @@ void asan_check_strings_memory_accesses(uint8_t* dst,
   }
 }
 
+// Check if a range of memory is accessible, and report an error on the first
+// bad byte of the range.
+// @param location The start of the range.
+// @param length The length of the range, in bytes.
+// @param access_mode The mode of the access.
+// @param context The registers context of the access.
+void asan_check_range_memory_access(uint8_t* location,
+                                    uint32_t length,
+                                    AccessMode access_mode,
+                                    const AsanContext& context) {
+  if (memory_interceptor_shadow_ == nullptr)
+    return;
+
+  const void* poisoned =
+      memory_interceptor_shadow_->FindFirstPoisonedByte(location, length);
+  if (poisoned != nullptr) {
+    ReportBadMemoryAccess(const_cast<void*>(poisoned), access_mode, length,
+                          context);
+  }
+}
+
 // Redirect stub for the SyzyAsan probes.
 MemoryAccessorFunction asan_redirect_stub_entry(
     const void* caller_address,
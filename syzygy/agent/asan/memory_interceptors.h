@@ -161,6 +161,12 @@ extern const size_t kNumClangMemoryAccessorVariants;
   F(stos, _, 1, AsanWriteAccess, AsanUnknownAccess, 2, 0)        \
   F(stos, _, 1, AsanWriteAccess, AsanUnknownAccess, 1, 0)
 
+// List of the range checking functions. These check a whole range of memory
+// at once, and are used for runs of accesses to adjacent memory locations.
+#define ASAN_RANGE_INTERCEPT_FUNCTIONS(F) \
+  F(read_access, AsanReadAccess)          \
+  F(write_access, AsanWriteAccess)
+
 #endif  // !defined(_WIN64)
 
 // List of the Asan-Clang memory accessor functions.
@@ -204,6 +210,11 @@ void asan_clang_no_check(const void*);
 // The no-op string instruction memory access checker.
 void asan_string_no_check();
 
+#ifndef _WIN64
+// The no-op range memory access checker.
+void asan_range_no_check();
+#endif
+
 // The table containing the array of shadow memory references. This is made
 // visible so that it can be used by the memory interceptor patcher. The table
 // itself will not be modified, but the pointers it points to will be.
@@ -235,6 +246,16 @@ ASAN_MEM_INTERCEPT_FUNCTIONS(DECLARE_MEM_INTERCEPT_FUNCTIONS)
 ASAN_STRING_INTERCEPT_FUNCTIONS(DECLARE_STRING_INTERCEPT_FUNCTIONS)
 
 #undef DECLARE_STRING_INTERCEPT_FUNCTIONS
+
+#define DECLARE_RANGE_INTERCEPT_FUNCTIONS(access_mode_str, access_mode) \
+  void asan_redirect_range_##access_mode_str();                         \
+  void asan_check_range_##access_mode_str();
+
+// Declare all the range interceptor functions. Note that these functions have
+// a custom calling convention, and can't be invoked directly.
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DECLARE_RANGE_INTERCEPT_FUNCTIONS)
+
+#undef DECLARE_RANGE_INTERCEPT_FUNCTIONS
 #endif  // !defined(_WIN64)
 
 #ifndef _WIN64
@@ -35,14 +35,38 @@ using agent::asan::AsanRuntime;
 // @param addr The address being accessed.
 template <size_t access_size, size_t address_space_size, AccessMode access_mode>
 void asan_check(const void* addr) {
-  if (reinterpret_cast<uintptr_t>(addr) > address_space_size ||
-      !AsanRuntime::runtime()->shadow()->IsAccessible(addr)) {
-    CONTEXT ctx = {};
-    ::RtlCaptureContext(&ctx);
-    AsanContext asan_ctx = {};
-    ContextToAsanContext(ctx, &asan_ctx);
-    ReportBadMemoryAccess(addr, access_mode, access_size, asan_ctx);
+  uintptr_t address = reinterpret_cast<uintptr_t>(addr);
+  const void* location = addr;
+  if (address <= address_space_size) {
+    // The vast majority of accesses are to fully accessible granules, whose
+    // shadow byte is zero. Check for those inline, and leave the partially
+    // accessible granules and the redzones to the shadow. Both ends of the
+    // access are checked, so that an access running off the end of a
+    // partially accessible granule is caught.
+    const agent::asan::Shadow* shadow = AsanRuntime::runtime()->shadow();
+    const void* last = reinterpret_cast<const uint8_t*>(addr) + access_size - 1;
+    uintptr_t first_index = address >> agent::asan::kShadowRatioLog;
+    uintptr_t last_index =
+        reinterpret_cast<uintptr_t>(last) >> agent::asan::kShadowRatioLog;
+    if (last_index < shadow->length() && shadow->shadow()[first_index] == 0 &&
+        shadow->shadow()[last_index] == 0) {
+      return;
+    }
+    if (shadow->IsAccessible(addr)) {
+      if (shadow->IsAccessible(last))
+        return;
+      // Report the end of the access, which is the byte that is out of bounds.
+      location = last;
+    }
   }
+
+  // The context is captured here rather than in a helper function, so that it
+  // describes the frame of the probe.
+  CONTEXT ctx = {};
+  ::RtlCaptureContext(&ctx);
+  AsanContext asan_ctx = {};
+  ContextToAsanContext(ctx, &asan_ctx);
+  ReportBadMemoryAccess(location, access_mode, access_size, asan_ctx);
 }
 
 // A few macros to instantiate 'asan_check' and export the instantiations
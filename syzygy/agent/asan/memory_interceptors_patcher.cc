@@ -14,7 +14,8 @@
 
 #include "syzygy/agent/asan/memory_interceptors_patcher.h"
 
-#include <map>
+#include <algorithm>
+#include <vector>
 
 #include "base/win/pe_image.h"
 #include "syzygy/agent/asan/memory_interceptors.h"
@@ -193,7 +194,11 @@ bool PatchMemoryInterceptorShadowReferencesInternalImpl(
     return false;
   }
 
-  // Iterate over the shadow memory references and patch them.
+  // Validate all of the shadow memory references before touching any of
+  // them, so that a bad table doesn't leave the probes half patched.
+  std::vector<volatile uint8_t**> shadow_refs;
+  uint8_t* refs_begin = probes_end;
+  uint8_t* refs_end = probes_begin;
   uint8_t** cursor = reinterpret_cast<uint8_t**>(const_cast<void**>(
       shadow_memory_references));
   for (; *cursor != nullptr; ++cursor) {
@@ -222,18 +227,41 @@ bool PatchMemoryInterceptorShadowReferencesInternalImpl(
       return false;
     }
 
-    // Update the shadow memory reference to point to the new shadow memory.
-    if (!scoped_page_protections->EnsureContainingPagesWritable(
-            shadow_ref, sizeof(*shadow_ref))) {
-      LOG(ERROR) << "Failed to make page writable.";
-      return false;
+    shadow_refs.push_back(shadow_ref);
+    refs_begin = std::min(refs_begin, *cursor);
+    refs_end = std::max(refs_end, *cursor + sizeof(*shadow_ref));
+  }
+  if (shadow_refs.empty())
+    return true;
+
+  // The references are all in the probes section, so the pages containing
+  // them are unprotected at once.
+  if (!scoped_page_protections->EnsureContainingPagesWritable(
+          refs_begin, refs_end - refs_begin)) {
+    LOG(ERROR) << "Failed to make pages writable.";
+    return false;
+  }
+
+  // Update the shadow memory references to point to the new shadow memory. If
+  // any write fails then the references already updated are reverted, as the
+  // probes must all agree on the shadow in use.
+  for (size_t i = 0; i < shadow_refs.size(); ++i) {
+    if (WritePointer(current_shadow_memory, new_shadow_memory,
+                     reinterpret_cast<volatile void**>(shadow_refs[i]))) {
+      continue;
     }
-    if (!WritePointer(current_shadow_memory, new_shadow_memory,
-                      reinterpret_cast<volatile void**>(shadow_ref))) {
-      return false;
+    while (i > 0) {
+      --i;
+      WritePointer(new_shadow_memory, current_shadow_memory,
+                   reinterpret_cast<volatile void**>(shadow_refs[i]));
     }
+    return false;
   }
 
+  // The references are embedded in the probes' code.
+  ::FlushInstructionCache(::GetCurrentProcess(), refs_begin,
+                          refs_end - refs_begin);
+
   return true;
 }
 
@@ -17,6 +17,7 @@
 #include "base/bind.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/agent/asan/rtl_impl.h"
 #include "syzygy/agent/asan/unittest_util.h"
 
 namespace agent {
@@ -25,6 +26,7 @@ namespace asan {
 namespace {
 
 using testing::_;
+using testing::ClangMemoryAccessorTester;
 using testing::MemoryAccessorTester;
 using testing::Return;
 using testing::TestMemoryInterceptors;
@@ -107,6 +109,27 @@ ASAN_STRING_INTERCEPT_FUNCTIONS(DEFINE_STRING_REDIRECT_FUNCTION_TABLE)
 
 #undef DEFINE_STRING_REDIRECT_FUNCTION_TABLE
 };
+
+static const TestMemoryInterceptors::RangeInterceptFunction
+    range_intercept_functions[] = {
+#define DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE(access_mode_str, access_mode) \
+  { asan_check_range_##access_mode_str, TestMemoryInterceptors::access_mode },
+
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE)
+
+#undef DEFINE_RANGE_INTERCEPT_FUNCTION_TABLE
+};
+
+static const TestMemoryInterceptors::RangeInterceptFunction
+    range_redirect_functions[] = {
+#define DEFINE_RANGE_REDIRECT_FUNCTION_TABLE(access_mode_str, access_mode) \
+  { asan_redirect_range_##access_mode_str,                                \
+    TestMemoryInterceptors::access_mode },
+
+ASAN_RANGE_INTERCEPT_FUNCTIONS(DEFINE_RANGE_REDIRECT_FUNCTION_TABLE)
+
+#undef DEFINE_RANGE_REDIRECT_FUNCTION_TABLE
+};
 #endif
 
 static const TestMemoryInterceptors::ClangInterceptFunction
@@ -325,6 +348,74 @@ TYPED_TEST(MemoryInterceptorsTypedTest, TestRedirectorsSmallMemory) {
   tester_.TestRedirectorUnderrunAccess();
 }
 
+TEST_F(MemoryInterceptorsTest, TestClangAccessibleGranule) {
+  for (const auto& fn : clang_intercept_functions) {
+    // An access ending on the last byte of the allocation is valid.
+    ClangMemoryAccessorTester tester;
+    tester.CheckAccess(reinterpret_cast<FARPROC>(fn.function),
+                       src_ + kAllocSize - fn.size);
+    EXPECT_FALSE(tester.memory_error_detected());
+  }
+}
+
+TEST_F(MemoryInterceptorsTest, TestClangPartiallyAccessibleGranule) {
+  // An allocation whose last granule is only partially accessible.
+  static const size_t kPartialSize = 61;
+  uint8_t* alloc =
+      reinterpret_cast<uint8_t*>(asan_HeapAlloc(heap_, 0, kPartialSize));
+  ASSERT_NE(static_cast<uint8_t*>(nullptr), alloc);
+  EXPECT_EQ(kHeapPartiallyAddressableByte5,
+            asan_runtime_.shadow()->GetShadowMarkerForAddress(
+                alloc + kPartialSize - 1));
+
+  for (const auto& fn : clang_intercept_functions) {
+    // An access ending on the last accessible byte of the granule is valid.
+    {
+      ClangMemoryAccessorTester tester;
+      tester.CheckAccess(reinterpret_cast<FARPROC>(fn.function),
+                         alloc + kPartialSize - fn.size);
+      EXPECT_FALSE(tester.memory_error_detected());
+    }
+
+    // An access crossing the end of the accessible bytes is caught, and is
+    // reported at the first inaccessible byte.
+    {
+      ClangMemoryAccessorTester tester;
+      tester.AssertMemoryErrorIsDetected(
+          reinterpret_cast<FARPROC>(fn.function),
+          alloc + kPartialSize - fn.size + 1,
+          ClangMemoryAccessorTester::BadAccessKind::HEAP_BUFFER_OVERFLOW);
+      EXPECT_EQ(static_cast<const void*>(alloc + kPartialSize),
+                tester.last_error_info().location);
+    }
+  }
+
+  EXPECT_TRUE(asan_HeapFree(heap_, 0, alloc));
+}
+
+TEST_F(MemoryInterceptorsTest, TestClangFullyPoisonedGranule) {
+  ASSERT_TRUE(ShadowMarkerHelper::IsRedzone(
+      asan_runtime_.shadow()->GetShadowMarkerForAddress(src_ + kAllocSize)));
+
+  for (const auto& fn : clang_intercept_functions) {
+    // An access inside the granule following the allocation is caught.
+    {
+      ClangMemoryAccessorTester tester;
+      tester.AssertMemoryErrorIsDetected(
+          reinterpret_cast<FARPROC>(fn.function), src_ + kAllocSize,
+          ClangMemoryAccessorTester::BadAccessKind::HEAP_BUFFER_OVERFLOW);
+    }
+
+    // So is an access starting in the allocation and ending in that granule.
+    if (fn.size > 1) {
+      ClangMemoryAccessorTester tester;
+      tester.AssertMemoryErrorIsDetected(
+          reinterpret_cast<FARPROC>(fn.function), src_ + kAllocSize - 1,
+          ClangMemoryAccessorTester::BadAccessKind::HEAP_BUFFER_OVERFLOW);
+    }
+  }
+}
+
 #ifndef _WIN64
 TEST_F(MemoryInterceptorsTest, TestStringValidAccess) {
   TestStringValidAccess(string_intercept_functions);
@@ -361,6 +452,39 @@ TEST_F(MemoryInterceptorsTest, TestStringRedirectors2G) {
       .WillRepeatedly(Return(MEMORY_ACCESSOR_MODE_2G));
   TestStringOverrunAccess(string_redirect_functions);
 }
+
+TEST_F(MemoryInterceptorsTest, TestRangeValidAccess) {
+  TestRangeValidAccess(range_intercept_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeOverrunAccess) {
+  TestRangeOverrunAccess(range_intercept_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeUnderrunAccess) {
+  TestRangeUnderrunAccess(range_intercept_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeRedirectorsNoop) {
+  EXPECT_CALL(*this, OnRedirectorInvocation(_))
+      // Each function is tested on two valid ranges.
+      .Times(2 * arraysize(range_redirect_functions))
+      .WillRepeatedly(Return(MEMORY_ACCESSOR_MODE_NOOP));
+
+  TestRangeValidAccess(range_redirect_functions);
+}
+
+TEST_F(MemoryInterceptorsTest, TestRangeRedirectors2G) {
+  EXPECT_CALL(*this, OnRedirectorInvocation(_))
+      // Each function is tested on two valid ranges, then on an overrun and
+      // an underrun.
+      .Times(4 * arraysize(range_redirect_functions))
+      .WillRepeatedly(Return(MEMORY_ACCESSOR_MODE_2G));
+
+  TestRangeValidAccess(range_redirect_functions);
+  TestRangeOverrunAccess(range_redirect_functions);
+  TestRangeUnderrunAccess(range_redirect_functions);
+}
 #endif
 
 }  // namespace asan
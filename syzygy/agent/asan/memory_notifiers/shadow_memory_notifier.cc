@@ -36,17 +36,55 @@ void AlignRange(const void** address, size_t* size) {
 
 }  // namespace
 
+ShadowMemoryNotifier::ShadowMemoryNotifier(Shadow* shadow)
+    : pending_start_(nullptr), pending_end_(nullptr), shadow_(shadow) {
+  DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
+}
+
+ShadowMemoryNotifier::~ShadowMemoryNotifier() {
+  Flush();
+}
+
 void ShadowMemoryNotifier::NotifyInternalUse(
     const void* address, size_t size) {
   DCHECK_NE(static_cast<void*>(nullptr), address);
   AlignRange(&address, &size);
-  shadow_->Poison(address, size, kAsanMemoryMarker);
+  const uint8_t* start = reinterpret_cast<const uint8_t*>(address);
+  const uint8_t* end = start + size;
+
+  base::AutoLock lock(lock_);
+
+  // Extend the pending range if this one is adjacent to it.
+  if (HasPendingInternalUse()) {
+    if (end == pending_start_) {
+      pending_start_ = start;
+      return;
+    }
+    if (start == pending_end_) {
+      pending_end_ = end;
+      return;
+    }
+    FlushUnlocked();
+  }
+
+  pending_start_ = start;
+  pending_end_ = end;
 }
 
 void ShadowMemoryNotifier::NotifyFutureHeapUse(
     const void* address, size_t size) {
   DCHECK_NE(static_cast<void*>(nullptr), address);
   AlignRange(&address, &size);
+  const uint8_t* start = reinterpret_cast<const uint8_t*>(address);
+  const uint8_t* end = start + size;
+
+  base::AutoLock lock(lock_);
+
+  // Writes to disjoint ranges can be reordered, but an overlapping pending
+  // range must be written first.
+  if (HasPendingInternalUse() && start < pending_end_ && pending_start_ < end)
+    FlushUnlocked();
+
   shadow_->Poison(address, size, kAsanReservedMarker);
 }
 
@@ -54,7 +92,45 @@ void ShadowMemoryNotifier::NotifyReturnedToOS(
     const void* address, size_t size) {
   DCHECK_NE(static_cast<void*>(nullptr), address);
   AlignRange(&address, &size);
-  shadow_->Unpoison(address, size);
+  const uint8_t* start = reinterpret_cast<const uint8_t*>(address);
+  const uint8_t* end = start + size;
+
+  base::AutoLock lock(lock_);
+
+  // The release overwrites the part of the pending range that it overlaps,
+  // so there's no need to write it. The pending range can only be trimmed
+  // from its ends without being split, otherwise it's written first.
+  if (HasPendingInternalUse() && start < pending_end_ &&
+      pending_start_ < end) {
+    if (start <= pending_start_ && pending_end_ <= end) {
+      pending_start_ = nullptr;
+      pending_end_ = nullptr;
+    } else if (start <= pending_start_) {
+      pending_start_ = end;
+    } else if (pending_end_ <= end) {
+      pending_end_ = start;
+    } else {
+      FlushUnlocked();
+    }
+  }
+
+  shadow_->ReleaseMemory(address, size);
+}
+
+void ShadowMemoryNotifier::Flush() {
+  base::AutoLock lock(lock_);
+  FlushUnlocked();
+}
+
+void ShadowMemoryNotifier::FlushUnlocked() {
+  lock_.AssertAcquired();
+  if (!HasPendingInternalUse())
+    return;
+
+  shadow_->Poison(pending_start_, pending_end_ - pending_start_,
+                  kAsanMemoryMarker);
+  pending_start_ = nullptr;
+  pending_end_ = nullptr;
 }
 
 }  // namespace memory_notifiers
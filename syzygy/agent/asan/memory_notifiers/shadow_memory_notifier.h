@@ -14,11 +14,21 @@
 //
 // Declares ShadowMemoryNotifier, an implementation of MemoryNotifierInterface
 // that modifies the shadow memory upon receiving memory notifications.
+//
+// Internal allocations come in bursts, and are often released shortly after
+// being made. The poisoning of internal memory is thus deferred: adjacent
+// internal ranges are coalesced into a single pending write, and a release
+// of the pending range simply cancels it. Releases and future heap use
+// reservations are written immediately, as memory handed back to the OS or
+// to the heaps may be accessed by instrumented code as soon as the
+// notification returns. Deferring the poisoning never causes a false
+// positive, it only delays the detection of accesses to internal memory.
 
 #ifndef SYZYGY_AGENT_ASAN_MEMORY_NOTIFIERS_SHADOW_MEMORY_NOTIFIER_H_
 #define SYZYGY_AGENT_ASAN_MEMORY_NOTIFIERS_SHADOW_MEMORY_NOTIFIER_H_
 
 #include "base/logging.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/agent/asan/memory_notifier.h"
 
 namespace agent {
@@ -35,12 +45,10 @@ class ShadowMemoryNotifier : public MemoryNotifierInterface {
  public:
   // Constructor.
   // @param shadow The shadow memory to notify.
-  explicit ShadowMemoryNotifier(Shadow* shadow) : shadow_(shadow) {
-    DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
-  }
+  explicit ShadowMemoryNotifier(Shadow* shadow);
 
-  // Virtual destructor.
-  virtual ~ShadowMemoryNotifier() { }
+  // Virtual destructor. Writes the pending notifications.
+  virtual ~ShadowMemoryNotifier();
 
   // @name MemoryNotifierInterface implementation.
   // @{
@@ -49,6 +57,26 @@ class ShadowMemoryNotifier : public MemoryNotifierInterface {
   virtual void NotifyReturnedToOS(const void* address, size_t size);
   // @}
 
+  // Writes the pending notifications to the shadow. This must be called
+  // before inspecting the shadow of internal memory, e.g. when reporting an
+  // error.
+  void Flush();
+
+ protected:
+  // Writes the pending notifications to the shadow. Must be called under
+  // lock_.
+  void FlushUnlocked();
+
+  // @returns true if there is a pending internal use range. Under lock_.
+  bool HasPendingInternalUse() const { return pending_start_ < pending_end_; }
+
+  // Protects the pending range.
+  base::Lock lock_;
+
+  // The internal use range whose poisoning is pending. Under lock_.
+  const uint8_t* pending_start_;
+  const uint8_t* pending_end_;
+
  private:
   // The shadow that is being notified.
   Shadow* shadow_;
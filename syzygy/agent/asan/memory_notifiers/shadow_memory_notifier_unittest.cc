@@ -48,6 +48,7 @@ TEST_F(ShadowMemoryNotifierTest, ShadowStateTransitionsWithNotification) {
 
   ShadowMemoryNotifier n(&shadow_);
   n.NotifyInternalUse(buffer.get(), kBufferSize);
+  n.Flush();
   EXPECT_FALSE(shadow_.IsAccessible(buffer.get()));
   EXPECT_FALSE(shadow_.IsAccessible(buffer.get() + 10));
   EXPECT_TRUE(shadow_.IsAccessible(buffer.get() + kBufferSize));
@@ -77,6 +78,80 @@ TEST_F(ShadowMemoryNotifierTest, ShadowStateTransitionsWithNotification) {
   EXPECT_TRUE(shadow_.IsClean());
 }
 
+TEST_F(ShadowMemoryNotifierTest, InternalUseIsCoalesced) {
+  const size_t kBufferSize = 1024;
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[kBufferSize]);
+  uint8_t* middle = buffer.get() + kBufferSize / 2;
+
+  ShadowMemoryNotifier n(&shadow_);
+
+  // Adjacent ranges are written at once, when flushed.
+  n.NotifyInternalUse(middle, kBufferSize / 4);
+  n.NotifyInternalUse(buffer.get() + kBufferSize / 4, kBufferSize / 4);
+  n.NotifyInternalUse(middle + kBufferSize / 4, kBufferSize / 4);
+  EXPECT_TRUE(shadow_.IsAccessible(middle));
+  n.Flush();
+  EXPECT_TRUE(shadow_.IsAccessible(buffer.get()));
+  for (size_t i = kBufferSize / 4; i < kBufferSize; ++i) {
+    EXPECT_EQ(kAsanMemoryMarker,
+              shadow_.GetShadowMarkerForAddress(buffer.get() + i));
+  }
+  n.NotifyReturnedToOS(buffer.get(), kBufferSize);
+  EXPECT_TRUE(shadow_.IsClean());
+
+  // A range that isn't adjacent writes the pending one.
+  n.NotifyInternalUse(buffer.get(), kBufferSize / 4);
+  n.NotifyInternalUse(middle, kBufferSize / 4);
+  EXPECT_FALSE(shadow_.IsAccessible(buffer.get()));
+  EXPECT_TRUE(shadow_.IsAccessible(middle));
+  n.Flush();
+  EXPECT_FALSE(shadow_.IsAccessible(middle));
+  n.NotifyReturnedToOS(buffer.get(), kBufferSize);
+  EXPECT_TRUE(shadow_.IsClean());
+
+  // So does a future heap use of an overlapping range.
+  n.NotifyInternalUse(buffer.get(), kBufferSize);
+  n.NotifyFutureHeapUse(middle, kBufferSize / 2);
+  EXPECT_EQ(kAsanMemoryMarker,
+            shadow_.GetShadowMarkerForAddress(buffer.get()));
+  EXPECT_EQ(kAsanReservedMarker, shadow_.GetShadowMarkerForAddress(middle));
+  n.NotifyReturnedToOS(buffer.get(), kBufferSize);
+  EXPECT_TRUE(shadow_.IsClean());
+}
+
+TEST_F(ShadowMemoryNotifierTest, ReleaseCancelsPendingInternalUse) {
+  const size_t kBufferSize = 1024;
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[kBufferSize]);
+  uint8_t* middle = buffer.get() + kBufferSize / 2;
+
+  ShadowMemoryNotifier n(&shadow_);
+
+  // Releasing the whole pending range cancels it.
+  n.NotifyInternalUse(buffer.get(), kBufferSize);
+  n.NotifyReturnedToOS(buffer.get(), kBufferSize);
+  n.Flush();
+  EXPECT_TRUE(shadow_.IsClean());
+
+  // Releasing one end of it trims it.
+  n.NotifyInternalUse(buffer.get(), kBufferSize);
+  n.NotifyReturnedToOS(middle, kBufferSize / 2);
+  n.Flush();
+  EXPECT_FALSE(shadow_.IsAccessible(buffer.get()));
+  EXPECT_FALSE(shadow_.IsAccessible(middle - 1));
+  EXPECT_TRUE(shadow_.IsAccessible(middle));
+  n.NotifyReturnedToOS(buffer.get(), kBufferSize);
+  EXPECT_TRUE(shadow_.IsClean());
+
+  // Releasing its middle writes it first.
+  n.NotifyInternalUse(buffer.get(), kBufferSize);
+  n.NotifyReturnedToOS(middle, kShadowRatio);
+  EXPECT_FALSE(shadow_.IsAccessible(buffer.get()));
+  EXPECT_TRUE(shadow_.IsAccessible(middle));
+  EXPECT_FALSE(shadow_.IsAccessible(middle + kShadowRatio));
+  n.NotifyReturnedToOS(buffer.get(), kBufferSize);
+  EXPECT_TRUE(shadow_.IsClean());
+}
+
 }  // namespace memory_notifiers
 }  // namespace asan
 }  // namespace agent
@@ -26,6 +26,8 @@
 #ifndef SYZYGY_AGENT_ASAN_PAGE_ALLOCATOR_H_
 #define SYZYGY_AGENT_ASAN_PAGE_ALLOCATOR_H_
 
+#include <windows.h>
+
 #include "base/synchronization/lock.h"
 
 namespace agent {
@@ -67,6 +69,14 @@ class PageAllocator {
   typedef detail::PageAllocatorPage<kObjectSize, kPageSize> Page;
   typedef typename Page::Object Object;
 
+  // The maximum number of freed objects of each size class that are kept in
+  // the cache of a thread.
+  static const size_t kThreadCacheCapacity = 64;
+
+  // The number of objects that are moved at once between the cache of a
+  // thread and the shared free lists.
+  static const size_t kThreadCacheBatchSize = kThreadCacheCapacity / 2;
+
   // Constructor.
   PageAllocator();
 
@@ -94,6 +104,20 @@ class PageAllocator {
   //     number of objects originally allocated.
   void Free(void* object, size_t count);
 
+  // Enables the per-thread caches of freed objects. Once enabled each thread
+  // serves allocations of exactly the requested size class from its own
+  // cache, and refills or drains it against the shared free lists in batches
+  // of kThreadCacheBatchSize. This must be called before the allocator is
+  // used.
+  // @returns true on success, false if no TLS slot was available, in which
+  //     case the allocator keeps functioning without per-thread caches.
+  bool EnableThreadCaches();
+
+  // @returns true if the per-thread caches are enabled.
+  bool thread_caches_enabled() const {
+    return thread_cache_tls_ != TLS_OUT_OF_INDEXES;
+  }
+
   // Returns current statistics. If kKeepStats is false this is a noop and
   // does not set any meaningful data.
   // @param stats The statistics data to be populated.
@@ -148,6 +172,49 @@ class PageAllocator {
   // @note Handles locking, so no locks must already be held.
   bool IsInFreeList(const void* object, size_t count);
 
+  // The cache of freed objects belonging to a thread, with one list per size
+  // class. The caches of all threads are chained together so that they can be
+  // inspected and released by the allocator.
+  struct ThreadCache {
+    // Protects the lists. This is only ever contended when the allocator is
+    // being inspected by another thread.
+    base::Lock lock;
+    // The freed objects, and their number, per size class. Under lock.
+    Object* free[kMaxObjectCount];
+    size_t count[kMaxObjectCount];
+    // The next cache in the chain. Under thread_caches_lock_.
+    ThreadCache* next;
+  };
+
+  // Returns the cache of the calling thread, creating it if necessary.
+  // @returns the cache of the calling thread, or nullptr if the per-thread
+  //     caches are disabled or the cache couldn't be created.
+  ThreadCache* GetThreadCache();
+
+  // Determines if an allocation is currently in the cache of any thread.
+  // @param object The object to be checked.
+  // @param count The size class to check, or zero to check all of them.
+  // @returns true if the given object was found.
+  // @note Handles locking, so no locks must already be held.
+  bool IsInThreadCache(const void* object, size_t count);
+
+  // Unlinks up to @p max_objects items from the given free list at once.
+  // This does not update the statistics, as the objects remain freed.
+  // @param count The size class.
+  // @param max_objects The maximum number of items to unlink.
+  // @param objects Will receive the unlinked items, chained via next_free.
+  // @returns the number of items that were unlinked.
+  // @note Handles locking, so no free_lock_ should be already held.
+  size_t FreePopBatch(size_t count, size_t max_objects, Object** objects);
+
+  // Links a chain of items into the given free list at once. This does not
+  // update the statistics, as the objects are already accounted as freed.
+  // @param first The first item of the chain.
+  // @param last The last item of the chain.
+  // @param count The size class.
+  // @note Handles locking, so no free_lock_ should be already held.
+  void FreePushBatch(Object* first, Object* last, size_t count);
+
   // Pops the top item from the given free list.
   // @param count The size class.
   // @returns a pointer to the popped item, NULL if there was none.
@@ -195,6 +262,14 @@ class PageAllocator {
   // The global lock for the allocator.
   base::Lock lock_;
 
+  // The TLS slot holding the cache of each thread, or TLS_OUT_OF_INDEXES if
+  // the per-thread caches are disabled.
+  DWORD thread_cache_tls_;
+
+  // The chain of all of the thread caches. Under thread_caches_lock_.
+  ThreadCache* thread_caches_;
+  base::Lock thread_caches_lock_;
+
   // For keeping statistics. If kKeepStats == 0 this is an empty struct with
   // noop routines.
   detail::PageAllocatorStatisticsHelper<kKeepStats> stats_;
@@ -267,8 +342,14 @@ struct PageAllocatorStatistics {
   size_t allocated_objects;
   // The number of groups of objects living in free lists.
   size_t freed_groups;
-  // The total number of objects living in free lists.
+  // The total number of objects living in free lists, including those held
+  // by the per-thread caches.
   size_t freed_objects;
+  // The number of allocations served by the cache of the calling thread.
+  size_t thread_cache_hits;
+  // The number of allocations that missed the cache of the calling thread.
+  // Only counted when the per-thread caches are enabled.
+  size_t thread_cache_misses;
 };
 
 }  // namespace asan
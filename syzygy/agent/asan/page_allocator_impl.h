@@ -21,6 +21,7 @@
 #include <windows.h>
 
 #include <algorithm>
+#include <new>
 
 #include "base/logging.h"
 #include "syzygy/agent/asan/constants.h"
@@ -148,7 +149,8 @@ template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
 PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
 PageAllocator()
     : page_count_(0), slab_(nullptr), slab_cursor_(nullptr), page_(nullptr),
-      object_(nullptr) {
+      object_(nullptr), thread_cache_tls_(TLS_OUT_OF_INDEXES),
+      thread_caches_(nullptr) {
   static_assert(kPageSize > kObjectSize,
                 "Page size should be bigger than the object size.");
   static_assert(kObjectSize >= sizeof(uintptr_t), "Object size is too small.");
@@ -165,6 +167,17 @@ template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
          bool kKeepStats>
 PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
 ~PageAllocator() {
+  // Release the thread caches. The objects they hold live in the slabs, which
+  // are released below.
+  while (thread_caches_) {
+    ThreadCache* next = thread_caches_->next;
+    thread_caches_->~ThreadCache();
+    CHECK_EQ(TRUE, ::HeapFree(::GetProcessHeap(), 0, thread_caches_));
+    thread_caches_ = next;
+  }
+  if (thread_cache_tls_ != TLS_OUT_OF_INDEXES)
+    CHECK_EQ(TRUE, ::TlsFree(thread_cache_tls_));
+
   // Iterate over the pages and make not of the slab addresses. These will
   // be pages whose root address a multiple of the allocation granulairty.
   Page* page = page_;
@@ -223,6 +236,45 @@ Allocate(size_t count, size_t* received) {
 
   void* object = nullptr;
 
+  // Try the cache of the calling thread first, refilling it from the shared
+  // free list of this size class if it has run dry.
+  ThreadCache* thread_cache = GetThreadCache();
+  if (thread_cache != nullptr) {
+    size_t i = count - 1;
+    Object* cached = nullptr;
+    {
+      base::AutoLock lock(thread_cache->lock);
+      if (thread_cache->count[i] == 0) {
+        thread_cache->count[i] = FreePopBatch(
+            count, kThreadCacheBatchSize, &thread_cache->free[i]);
+      }
+      cached = thread_cache->free[i];
+      if (cached != nullptr) {
+        thread_cache->free[i] = cached->next_free;
+        --thread_cache->count[i];
+      }
+    }
+
+    // Update statistics.
+    stats_.Lock();
+    if (cached != nullptr) {
+      stats_.Increment<&PageAllocatorStatistics::thread_cache_hits>(1);
+      stats_.Increment<&PageAllocatorStatistics::allocated_groups>(1);
+      stats_.Increment<&PageAllocatorStatistics::allocated_objects>(count);
+      stats_.Decrement<&PageAllocatorStatistics::freed_groups>(1);
+      stats_.Decrement<&PageAllocatorStatistics::freed_objects>(count);
+    } else {
+      stats_.Increment<&PageAllocatorStatistics::thread_cache_misses>(1);
+    }
+    stats_.Unlock();
+
+    if (cached != nullptr) {
+      cached->next_free = nullptr;
+      *received = count;
+      return cached;
+    }
+  }
+
   // Look to the lists of freed objects and try to use one of those. Use the
   // first one that's big enough, and stuff the leftover objects into another
   // freed list.
@@ -292,12 +344,66 @@ Free(void* object, size_t count) {
   DCHECK_EQ(1, AllocationStatus(object, count));
 #endif
 
+  // Prefer the cache of the calling thread. When it is full the objects that
+  // have been cached the longest are returned to the shared free list.
+  ThreadCache* thread_cache = GetThreadCache();
+  if (thread_cache != nullptr) {
+    size_t i = count - 1;
+    Object* freed = reinterpret_cast<Object*>(object);
+    Object* first = nullptr;
+    Object* last = nullptr;
+    {
+      base::AutoLock lock(thread_cache->lock);
+      if (thread_cache->count[i] == kThreadCacheCapacity) {
+        // Keep the most recently freed objects, which are likely to still be
+        // warm in the CPU cache.
+        Object* keep = thread_cache->free[i];
+        for (size_t j = 1; j < kThreadCacheCapacity - kThreadCacheBatchSize;
+             ++j) {
+          keep = keep->next_free;
+        }
+        first = keep->next_free;
+        keep->next_free = nullptr;
+        last = first;
+        while (last->next_free)
+          last = last->next_free;
+        thread_cache->count[i] -= kThreadCacheBatchSize;
+      }
+      freed->next_free = thread_cache->free[i];
+      thread_cache->free[i] = freed;
+      ++thread_cache->count[i];
+    }
+
+    if (first != nullptr)
+      FreePushBatch(first, last, count);
+
+    // Update statistics. Cached objects are accounted as freed.
+    stats_.Lock();
+    stats_.Decrement<&PageAllocatorStatistics::allocated_groups>(1);
+    stats_.Decrement<&PageAllocatorStatistics::allocated_objects>(count);
+    stats_.Increment<&PageAllocatorStatistics::freed_groups>(1);
+    stats_.Increment<&PageAllocatorStatistics::freed_objects>(count);
+    stats_.Unlock();
+    return;
+  }
+
   // Add this object to the list of freed objects for this size class.
   // This is a simple allocation that is being returned so both allocated
   // groups and objects are decremented.
   FreePush(reinterpret_cast<Object*>(object), count, true, true);
 }
 
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+bool PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+EnableThreadCaches() {
+  if (thread_cache_tls_ != TLS_OUT_OF_INDEXES)
+    return true;
+  DCHECK(page_ == nullptr);
+  thread_cache_tls_ = ::TlsAlloc();
+  return thread_cache_tls_ != TLS_OUT_OF_INDEXES;
+}
+
 template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
          bool kKeepStats>
 void PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
@@ -319,6 +425,8 @@ AllocationStatus(const void* object, size_t count) {
   // The memory has been allocated, but it may since have been freed.
   if (IsInFreeList(object, count))
     return 0;
+  if (IsInThreadCache(object, count))
+    return 0;
   // It's been allocated and it's not in the freed list. Must still be
   // a valid allocation!
   return 1;
@@ -403,6 +511,119 @@ IsInFreeList(const void* object, size_t count) {
   return false;
 }
 
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+typename
+PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::ThreadCache*
+PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+    GetThreadCache() {
+  if (thread_cache_tls_ == TLS_OUT_OF_INDEXES)
+    return nullptr;
+
+  ThreadCache* thread_cache =
+      reinterpret_cast<ThreadCache*>(::TlsGetValue(thread_cache_tls_));
+  if (thread_cache != nullptr)
+    return thread_cache;
+
+  // This is the first time this thread uses the allocator. The cache is
+  // allocated from the process heap as the allocator only deals in objects
+  // of a fixed size.
+  void* memory = ::HeapAlloc(::GetProcessHeap(), 0, sizeof(ThreadCache));
+  if (memory == nullptr)
+    return nullptr;
+  thread_cache = new(memory) ThreadCache();
+  ::memset(thread_cache->free, 0, sizeof(thread_cache->free));
+  ::memset(thread_cache->count, 0, sizeof(thread_cache->count));
+
+  {
+    base::AutoLock lock(thread_caches_lock_);
+    thread_cache->next = thread_caches_;
+    thread_caches_ = thread_cache;
+  }
+
+  CHECK_EQ(TRUE, ::TlsSetValue(thread_cache_tls_, thread_cache));
+  return thread_cache;
+}
+
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+bool PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+IsInThreadCache(const void* object, size_t count) {
+  if (object == nullptr)
+    return false;
+
+  // Determine the range of size classes to investigate.
+  size_t n_min = 1;
+  size_t n_max = kMaxObjectCount;
+  if (count != 0) {
+    n_min = count;
+    n_max = count;
+  }
+
+  base::AutoLock lock(thread_caches_lock_);
+  for (ThreadCache* thread_cache = thread_caches_; thread_cache != nullptr;
+       thread_cache = thread_cache->next) {
+    base::AutoLock thread_cache_lock(thread_cache->lock);
+    for (size_t n = n_min; n <= n_max; ++n) {
+      Object* free = thread_cache->free[n - 1];
+      while (free) {
+        if (free == object)
+          return true;
+        free = free->next_free;
+      }
+    }
+  }
+
+  return false;
+}
+
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+size_t PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+    FreePopBatch(size_t count, size_t max_objects, Object** objects) {
+  DCHECK_LT(0u, count);
+  DCHECK_GE(kMaxObjectCount, count);
+  DCHECK_LT(0u, max_objects);
+  DCHECK_NE(static_cast<Object**>(nullptr), objects);
+
+  // This is racy, but avoids taking the lock when there is nothing to pop.
+  *objects = nullptr;
+  if (free_[count - 1] == nullptr)
+    return 0;
+
+  base::AutoLock lock(free_lock_[count - 1]);
+  Object* first = free_[count - 1];
+  if (first == nullptr)
+    return 0;
+
+  // Walk to the last object of the batch and cut the list there.
+  Object* last = first;
+  size_t popped = 1;
+  while (popped < max_objects && last->next_free != nullptr) {
+    last = last->next_free;
+    ++popped;
+  }
+  free_[count - 1] = last->next_free;
+  last->next_free = nullptr;
+
+  *objects = first;
+  return popped;
+}
+
+template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
+         bool kKeepStats>
+void PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
+    FreePushBatch(Object* first, Object* last, size_t count) {
+  DCHECK_NE(static_cast<Object*>(nullptr), first);
+  DCHECK_NE(static_cast<Object*>(nullptr), last);
+  DCHECK_LT(0u, count);
+  DCHECK_GE(kMaxObjectCount, count);
+
+  base::AutoLock lock(free_lock_[count - 1]);
+  last->next_free = free_[count - 1];
+  free_[count - 1] = first;
+}
+
 template<size_t kObjectSize, size_t kMaxObjectCount, size_t kPageSize,
          bool kKeepStats>
 typename
@@ -419,6 +640,8 @@ PageAllocator<kObjectSize, kMaxObjectCount, kPageSize, kKeepStats>::
     if (object)
       free_[count - 1] = object->next_free;
   }
+  if (object == nullptr)
+    return nullptr;
   object->next_free = nullptr;
 
   // Update statistics.
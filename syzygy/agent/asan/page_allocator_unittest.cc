@@ -14,6 +14,10 @@
 
 #include "syzygy/agent/asan/page_allocator.h"
 
+#include <memory>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 
 namespace agent {
@@ -86,6 +90,31 @@ class TestTypedPageAllocator
 typedef TestPageAllocator<16, 1, 4096> TestPageAllocator255;
 typedef TestPageAllocator<16, 10, 4096> TestPageAllocatorMulti255;
 
+// A thread that repeatedly allocates and frees objects.
+class AllocatorThread : public base::SimpleThread {
+ public:
+  static const size_t kIterations = 100;
+  static const size_t kObjectsPerIteration = 100;
+
+  explicit AllocatorThread(TestPageAllocator255* pa)
+      : base::SimpleThread("AllocatorThread"), pa_(pa) {
+  }
+
+  void Run() override {
+    std::vector<void*> allocs;
+    for (size_t i = 0; i < kIterations; ++i) {
+      for (size_t j = 0; j < kObjectsPerIteration; ++j)
+        allocs.push_back(pa_->Allocate(1));
+      for (size_t j = 0; j < allocs.size(); ++j)
+        pa_->Free(allocs[j], 1);
+      allocs.clear();
+    }
+  }
+
+ private:
+  TestPageAllocator255* pa_;
+};
+
 }  // namespace
 
 TEST(PageAllocatorTest, Constructor) {
@@ -401,6 +430,106 @@ TEST(PageAllocatorTest, MultiSlabsPagesBiggerThanAllGranularity) {
     pa.Allocate(1);
 }
 
+TEST(PageAllocatorTest, ThreadCacheReusesFreedObjects) {
+  TestPageAllocator255 pa;
+  EXPECT_FALSE(pa.thread_caches_enabled());
+  EXPECT_TRUE(pa.EnableThreadCaches());
+  EXPECT_TRUE(pa.thread_caches_enabled());
+
+  // The first allocation can't be served by the empty cache.
+  void* a1 = pa.Allocate(1);
+  EXPECT_EQ(0u, pa.stats().thread_cache_hits);
+  EXPECT_EQ(1u, pa.stats().thread_cache_misses);
+
+  // Freeing it places it in the cache of this thread rather than in the shared
+  // free list. It's still accounted as being freed.
+  pa.Free(a1, 1);
+  EXPECT_TRUE(pa.Freed(a1, 1));
+  EXPECT_FALSE(pa.Allocated(a1, 1));
+  EXPECT_EQ(0u, pa.FreeObjects(1));
+  EXPECT_EQ(0u, pa.stats().allocated_groups);
+  EXPECT_EQ(1u, pa.stats().freed_groups);
+  EXPECT_EQ(1u, pa.stats().freed_objects);
+
+  // The next allocation is served from the cache.
+  void* a2 = pa.Allocate(1);
+  EXPECT_EQ(a1, a2);
+  EXPECT_TRUE(pa.Allocated(a2, 1));
+  EXPECT_EQ(1u, pa.stats().thread_cache_hits);
+  EXPECT_EQ(1u, pa.stats().thread_cache_misses);
+  EXPECT_EQ(1u, pa.stats().allocated_groups);
+  EXPECT_EQ(0u, pa.stats().freed_groups);
+  EXPECT_EQ(0u, pa.stats().freed_objects);
+
+  pa.Free(a2, 1);
+}
+
+TEST(PageAllocatorTest, ThreadCacheMovesObjectsInBatches) {
+  static const size_t kCapacity = TestPageAllocator255::kThreadCacheCapacity;
+  static const size_t kBatchSize = TestPageAllocator255::kThreadCacheBatchSize;
+
+  TestPageAllocator255 pa;
+  EXPECT_TRUE(pa.EnableThreadCaches());
+
+  std::vector<void*> allocs;
+  for (size_t i = 0; i < kCapacity + 1; ++i)
+    allocs.push_back(pa.Allocate(1));
+
+  // Filling the cache doesn't touch the shared free list.
+  for (size_t i = 0; i < kCapacity; ++i)
+    pa.Free(allocs[i], 1);
+  EXPECT_EQ(0u, pa.FreeObjects(1));
+
+  // Overflowing it returns a batch of objects to the shared free list.
+  pa.Free(allocs[kCapacity], 1);
+  EXPECT_EQ(kBatchSize, pa.FreeObjects(1));
+  EXPECT_EQ(kCapacity + 1, pa.stats().freed_objects);
+  for (size_t i = 0; i < allocs.size(); ++i)
+    EXPECT_TRUE(pa.Freed(allocs[i], 1));
+
+  // Drain the cache. This doesn't touch the shared free list either.
+  size_t hits = pa.stats().thread_cache_hits;
+  allocs.clear();
+  for (size_t i = 0; i < kCapacity + 1 - kBatchSize; ++i)
+    allocs.push_back(pa.Allocate(1));
+  EXPECT_EQ(kBatchSize, pa.FreeObjects(1));
+  EXPECT_EQ(hits + allocs.size(), pa.stats().thread_cache_hits);
+
+  // The next allocation refills the cache with a batch from the shared free
+  // list.
+  allocs.push_back(pa.Allocate(1));
+  EXPECT_EQ(0u, pa.FreeObjects(1));
+  EXPECT_EQ(hits + allocs.size(), pa.stats().thread_cache_hits);
+
+  for (size_t i = 0; i < allocs.size(); ++i)
+    pa.Free(allocs[i], 1);
+  EXPECT_EQ(0u, pa.stats().allocated_groups);
+  EXPECT_EQ(kCapacity + 1, pa.stats().freed_objects);
+}
+
+TEST(PageAllocatorTest, ThreadCacheMultipleThreads) {
+  static const size_t kThreadCount = 4;
+
+  TestPageAllocator255 pa;
+  EXPECT_TRUE(pa.EnableThreadCaches());
+
+  std::vector<std::unique_ptr<AllocatorThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i)
+    threads.push_back(std::unique_ptr<AllocatorThread>(
+        new AllocatorThread(&pa)));
+  for (size_t i = 0; i < kThreadCount; ++i)
+    threads[i]->Start();
+  for (size_t i = 0; i < kThreadCount; ++i)
+    threads[i]->Join();
+
+  EXPECT_EQ(0u, pa.stats().allocated_groups);
+  EXPECT_EQ(0u, pa.stats().allocated_objects);
+  EXPECT_EQ(kThreadCount * AllocatorThread::kIterations *
+                AllocatorThread::kObjectsPerIteration,
+            pa.stats().thread_cache_hits + pa.stats().thread_cache_misses);
+  EXPECT_LT(0u, pa.stats().thread_cache_hits);
+}
+
 TEST(TypedPageAllocatorTest, SingleEndToEnd) {
   TypedPageAllocator<size_t, 1, 1000, true> pa;
   for (size_t i = 0; i < 1600; ++i) {
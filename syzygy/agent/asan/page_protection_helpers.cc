@@ -14,6 +14,10 @@
 
 #include "syzygy/agent/asan/page_protection_helpers.h"
 
+#include <algorithm>
+
+#include "syzygy/common/align.h"
+
 namespace agent {
 namespace asan {
 
@@ -22,6 +26,106 @@ namespace asan {
 
 ::common::RecursiveLock block_protect_lock;
 
+PageProtectionBatch::PageProtectionBatch(Shadow* shadow)
+    : shadow_(shadow), range_count_(0), system_call_count_(0) {
+  DCHECK_NE(static_cast<Shadow*>(nullptr), shadow);
+}
+
+PageProtectionBatch::~PageProtectionBatch() {
+  Commit();
+}
+
+void PageProtectionBatch::Protect(uint8_t* pages, size_t size) {
+  AddRange(pages, size, true);
+}
+
+void PageProtectionBatch::Unprotect(uint8_t* pages, size_t size) {
+  AddRange(pages, size, false);
+}
+
+void PageProtectionBatch::Commit() {
+  if (range_count_ == 0)
+    return;
+
+  ::common::AutoRecursiveLock lock(block_protect_lock);
+
+  // Ranges may have been added in any order, so sort them before merging
+  // the contiguous ones.
+  std::sort(ranges_, ranges_ + range_count_,
+            [](const Range& r1, const Range& r2) {
+              return r1.pages < r2.pages;
+            });
+
+  Range run = ranges_[0];
+  for (size_t i = 1; i < range_count_; ++i) {
+    const Range& range = ranges_[i];
+    DCHECK_LE(run.pages + run.size, range.pages);
+    if (range.protect == run.protect && run.pages + run.size == range.pages) {
+      run.size += range.size;
+      continue;
+    }
+    CommitRange(run);
+    run = range;
+  }
+  CommitRange(run);
+
+  range_count_ = 0;
+}
+
+void PageProtectionBatch::AddRange(uint8_t* pages, size_t size, bool protect) {
+  DCHECK_NE(static_cast<uint8_t*>(nullptr), pages);
+  DCHECK(::common::IsAligned(pages, GetPageSize()));
+  DCHECK(::common::IsAligned(size, GetPageSize()));
+  if (size == 0)
+    return;
+
+  // Ranges are usually added in address order, so try to extend the last
+  // one before consuming a new slot.
+  if (range_count_ > 0) {
+    Range& last = ranges_[range_count_ - 1];
+    if (last.protect == protect && last.pages + last.size == pages) {
+      last.size += size;
+      return;
+    }
+  }
+
+  if (range_count_ == kMaxRanges)
+    Commit();
+
+  Range& range = ranges_[range_count_++];
+  range.pages = pages;
+  range.size = size;
+  range.protect = protect;
+}
+
+void PageProtectionBatch::CommitRange(const Range& range) {
+  block_protect_lock.AssertAcquired();
+
+  // Page bits are only modified under block_protect_lock, so they can be
+  // trusted here. Skip the system call if there's nothing to change.
+  const uint8_t* range_end = range.pages + range.size;
+  const uint8_t* page = range.pages;
+  for (; page < range_end; page += GetPageSize()) {
+    if (shadow_->PageIsProtected(page) != range.protect)
+      break;
+  }
+  if (page == range_end)
+    return;
+
+  DWORD old_protection = 0;
+  DWORD ret = ::VirtualProtect(range.pages, range.size,
+                               range.protect ? PAGE_NOACCESS : PAGE_READWRITE,
+                               &old_protection);
+  ++system_call_count_;
+  if (range.protect) {
+    DCHECK_NE(0u, ret);
+    shadow_->MarkPagesProtected(range.pages, range.size);
+  } else {
+    CHECK_NE(0u, ret);
+    shadow_->MarkPagesUnprotected(range.pages, range.size);
+  }
+}
+
 bool GetBlockInfo(const Shadow* shadow,
                   const BlockBody* body,
                   CompactBlockInfo* block_info) {
@@ -64,15 +168,18 @@ void BlockProtectNone(const BlockInfo& block_info, Shadow* shadow) {
   if (block_info.block_pages_size == 0)
     return;
 
-  ::common::AutoRecursiveLock lock(block_protect_lock);
+  PageProtectionBatch batch(shadow);
+  BlockProtectNone(block_info, &batch);
+}
+
+void BlockProtectNone(const BlockInfo& block_info,
+                      PageProtectionBatch* batch) {
+  DCHECK_NE(static_cast<PageProtectionBatch*>(nullptr), batch);
+  if (block_info.block_pages_size == 0)
+    return;
+
   DCHECK_NE(static_cast<uint8_t*>(nullptr), block_info.block_pages);
-  DWORD old_protection = 0;
-  DWORD ret = ::VirtualProtect(block_info.block_pages,
-                               block_info.block_pages_size,
-                               PAGE_READWRITE, &old_protection);
-  CHECK_NE(0u, ret);
-  shadow->MarkPagesUnprotected(block_info.block_pages,
-                               block_info.block_pages_size);
+  batch->Unprotect(block_info.block_pages, block_info.block_pages_size);
 }
 
 void BlockProtectRedzones(const BlockInfo& block_info, Shadow* shadow) {
@@ -80,31 +187,44 @@ void BlockProtectRedzones(const BlockInfo& block_info, Shadow* shadow) {
   if (block_info.block_pages_size == 0)
     return;
 
-  ::common::AutoRecursiveLock lock(block_protect_lock);
-  BlockProtectNone(block_info, shadow);
+  PageProtectionBatch batch(shadow);
+  BlockProtectRedzones(block_info, &batch);
+}
 
-  // Protect the left redzone pages if any.
-  DWORD old_protection = 0;
-  DWORD ret = 0;
+void BlockProtectRedzones(const BlockInfo& block_info,
+                          PageProtectionBatch* batch) {
+  DCHECK_NE(static_cast<PageProtectionBatch*>(nullptr), batch);
+  if (block_info.block_pages_size == 0)
+    return;
+
+  DCHECK_NE(static_cast<uint8_t*>(nullptr), block_info.block_pages);
+  uint8_t* body_pages = block_info.block_pages;
+  uint8_t* body_pages_end =
+      block_info.block_pages + block_info.block_pages_size;
+
+  // Protect the left redzone pages if any. These start the block pages.
   if (block_info.left_redzone_pages_size > 0) {
-    DCHECK_NE(static_cast<uint8_t*>(nullptr), block_info.left_redzone_pages);
-    ret = ::VirtualProtect(block_info.left_redzone_pages,
-                           block_info.left_redzone_pages_size,
-                           PAGE_NOACCESS, &old_protection);
-    DCHECK_NE(0u, ret);
-    shadow->MarkPagesProtected(block_info.left_redzone_pages,
-                               block_info.left_redzone_pages_size);
+    DCHECK_EQ(block_info.block_pages, block_info.left_redzone_pages);
+    batch->Protect(block_info.left_redzone_pages,
+                   block_info.left_redzone_pages_size);
+    body_pages += block_info.left_redzone_pages_size;
   }
 
-  // Protect the right redzone pages if any.
+  // The right redzone pages, if any, end the block pages.
+  if (block_info.right_redzone_pages_size > 0) {
+    DCHECK_EQ(body_pages_end, block_info.right_redzone_pages +
+                                  block_info.right_redzone_pages_size);
+    body_pages_end = block_info.right_redzone_pages;
+  }
+
+  // Unprotect the pages in between, which intersect the body.
+  if (body_pages < body_pages_end)
+    batch->Unprotect(body_pages, body_pages_end - body_pages);
+
   if (block_info.right_redzone_pages_size > 0) {
     DCHECK_NE(static_cast<uint8_t*>(nullptr), block_info.right_redzone_pages);
-    ret = ::VirtualProtect(block_info.right_redzone_pages,
-                           block_info.right_redzone_pages_size,
-                           PAGE_NOACCESS, &old_protection);
-    DCHECK_NE(0u, ret);
-    shadow->MarkPagesProtected(block_info.right_redzone_pages,
-                               block_info.right_redzone_pages_size);
+    batch->Protect(block_info.right_redzone_pages,
+                   block_info.right_redzone_pages_size);
   }
 }
 
@@ -113,15 +233,18 @@ void BlockProtectAll(const BlockInfo& block_info, Shadow* shadow) {
   if (block_info.block_pages_size == 0)
     return;
 
-  ::common::AutoRecursiveLock lock(block_protect_lock);
+  PageProtectionBatch batch(shadow);
+  BlockProtectAll(block_info, &batch);
+}
+
+void BlockProtectAll(const BlockInfo& block_info,
+                     PageProtectionBatch* batch) {
+  DCHECK_NE(static_cast<PageProtectionBatch*>(nullptr), batch);
+  if (block_info.block_pages_size == 0)
+    return;
+
   DCHECK_NE(static_cast<uint8_t*>(nullptr), block_info.block_pages);
-  DWORD old_protection = 0;
-  DWORD ret = ::VirtualProtect(block_info.block_pages,
-                               block_info.block_pages_size,
-                               PAGE_NOACCESS, &old_protection);
-  DCHECK_NE(0u, ret);
-  shadow->MarkPagesProtected(block_info.block_pages,
-                             block_info.block_pages_size);
+  batch->Protect(block_info.block_pages, block_info.block_pages_size);
 }
 
 void BlockProtectAuto(const BlockInfo& block_info, Shadow* shadow) {
@@ -131,20 +254,17 @@ void BlockProtectAuto(const BlockInfo& block_info, Shadow* shadow) {
 
   ::common::AutoRecursiveLock lock(block_protect_lock);
 
-  // Remove the page protection from the header if necessary.
-  if (!shadow->IsAccessible(block_info.block_pages)) {
-    DWORD old_protection = 0;
-    DWORD ret = ::VirtualProtect(block_info.block_pages,
-                                 GetPageSize(),
-                                 PAGE_READWRITE, &old_protection);
-    DCHECK_NE(0u, ret);
-  }
+  // Remove the page protection from the header if necessary. This goes
+  // through the shadow so that its page bits stay in sync.
+  PageProtectionBatch batch(shadow);
+  batch.Unprotect(block_info.block_pages, GetPageSize());
+  batch.Commit();
 
   // Now set page protections based on the block state.
   switch (block_info.header->state) {
     // An allocated block has an accessible body but protected redzones.
     case ALLOCATED_BLOCK: {
-      BlockProtectRedzones(block_info, shadow);
+      BlockProtectRedzones(block_info, &batch);
       break;
     }
 
@@ -152,7 +272,7 @@ void BlockProtectAuto(const BlockInfo& block_info, Shadow* shadow) {
     case QUARANTINED_BLOCK:
     case QUARANTINED_FLOODED_BLOCK:
     case FREED_BLOCK: {
-      BlockProtectAll(block_info, shadow);
+      BlockProtectAll(block_info, &batch);
       break;
     }
 
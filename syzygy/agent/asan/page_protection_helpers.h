@@ -30,6 +30,69 @@ namespace asan {
 // other threads from tinkering with page protections.
 extern ::common::RecursiveLock block_protect_lock;
 
+// Collects page protection transitions and applies them with as few system
+// calls as possible. Contiguous ranges moving to the same protection are
+// coalesced into a single VirtualProtect call, and the page protection bits
+// of the shadow are updated once per coalesced range. Ranges that the shadow
+// already reports as being in the requested state are skipped. Pending
+// transitions are applied by Commit, when the batch fills up, and on
+// destruction. Pending ranges must not overlap.
+class PageProtectionBatch {
+ public:
+  // The maximum number of pending ranges. Adding a range to a full batch
+  // commits it first.
+  static const size_t kMaxRanges = 64;
+
+  // Constructor.
+  // @param shadow The shadow to update.
+  explicit PageProtectionBatch(Shadow* shadow);
+
+  // Destructor. Commits any pending transitions.
+  ~PageProtectionBatch();
+
+  // Adds a transition of the given pages to PAGE_NOACCESS.
+  // @param pages The first page of the range. Must be page aligned.
+  // @param size The size of the range. Must be a multiple of the page size.
+  void Protect(uint8_t* pages, size_t size);
+
+  // Adds a transition of the given pages to PAGE_READWRITE.
+  // @param pages The first page of the range. Must be page aligned.
+  // @param size The size of the range. Must be a multiple of the page size.
+  void Unprotect(uint8_t* pages, size_t size);
+
+  // Applies all of the pending transitions.
+  // @note Under block_protect_lock.
+  void Commit();
+
+  // @returns the number of pending ranges, after coalescing of ranges that
+  //     were added in address order.
+  size_t range_count() const { return range_count_; }
+
+  // @returns the number of VirtualProtect calls issued by this batch so far.
+  size_t system_call_count() const { return system_call_count_; }
+
+ private:
+  // A pending transition.
+  struct Range {
+    uint8_t* pages;
+    size_t size;
+    bool protect;
+  };
+
+  // Adds a range, extending the previous one when possible.
+  void AddRange(uint8_t* pages, size_t size, bool protect);
+
+  // Applies the transition of a single coalesced range.
+  void CommitRange(const Range& range);
+
+  Shadow* shadow_;
+  Range ranges_[kMaxRanges];
+  size_t range_count_;
+  size_t system_call_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(PageProtectionBatch);
+};
+
 // Given a pointer to the body of a block extracts its layout. If the block
 // header is not under any block protections then the layout will be read from
 // the header. If the header is corrupt, or the memory is otherwise unreadable,
@@ -56,6 +119,12 @@ bool GetBlockInfo(const Shadow* shadow,
 // @note Under block_protect_lock.
 void BlockProtectNone(const BlockInfo& block_info, Shadow* shadow);
 
+// Adds the transitions of BlockProtectNone to the given batch. These are only
+// applied when the batch is committed.
+// @param block_info The block whose protections are to be modified.
+// @param batch The batch receiving the transitions.
+void BlockProtectNone(const BlockInfo& block_info, PageProtectionBatch* batch);
+
 // Protects all entire pages that are spanned by the redzones of the
 // block. All pages intersecting the body of the block will be explicitly
 // unprotected. All pages not intersecting the body but only partially
@@ -65,6 +134,13 @@ void BlockProtectNone(const BlockInfo& block_info, Shadow* shadow);
 // @note Under block_protect_lock.
 void BlockProtectRedzones(const BlockInfo& block_info, Shadow* shadow);
 
+// Adds the transitions of BlockProtectRedzones to the given batch. These are
+// only applied when the batch is committed.
+// @param block_info The block whose protections are to be modified.
+// @param batch The batch receiving the transitions.
+void BlockProtectRedzones(const BlockInfo& block_info,
+                          PageProtectionBatch* batch);
+
 // Protects all pages completely spanned by the block. All pages
 // intersecting but not fully covered by the block will be left in their
 // current state.
@@ -73,6 +149,12 @@ void BlockProtectRedzones(const BlockInfo& block_info, Shadow* shadow);
 // @note Under block_protect_lock.
 void BlockProtectAll(const BlockInfo& block_info, Shadow* shadow);
 
+// Adds the transitions of BlockProtectAll to the given batch. These are only
+// applied when the batch is committed.
+// @param block_info The block whose protections are to be modified.
+// @param batch The batch receiving the transitions.
+void BlockProtectAll(const BlockInfo& block_info, PageProtectionBatch* batch);
+
 // Sets the block protections according to the block state. If in the allocated
 // state uses BlockProtectRedzones. If in quarantined or freed uses
 // BlockProtectAll.
@@ -249,6 +249,64 @@ TEST_F(PageProtectionHelpersTest, GetBlockInfo) {
   ::VirtualFree(alloc, layout.block_size, MEM_RELEASE);
 }
 
+TEST_F(PageProtectionHelpersTest, PageProtectionBatch) {
+  const size_t kPageSize = GetPageSize();
+  uint8_t* pages = reinterpret_cast<uint8_t*>(
+      ::VirtualAlloc(nullptr, 4 * kPageSize, MEM_COMMIT, PAGE_READWRITE));
+  ASSERT_TRUE(pages != nullptr);
+
+  {
+    PageProtectionBatch batch(&shadow_);
+
+    // Contiguous ranges are coalesced, regardless of the order in which they
+    // were added.
+    batch.Protect(pages + 2 * kPageSize, kPageSize);
+    batch.Protect(pages, kPageSize);
+    batch.Protect(pages + kPageSize, kPageSize);
+    EXPECT_EQ(3u, batch.range_count());
+    batch.Commit();
+    EXPECT_EQ(0u, batch.range_count());
+    EXPECT_EQ(1u, batch.system_call_count());
+    EXPECT_TRUE(IsNotAccessible(pages));
+    EXPECT_TRUE(IsNotAccessible(pages + kPageSize));
+    EXPECT_TRUE(IsNotAccessible(pages + 2 * kPageSize));
+    EXPECT_TRUE(IsAccessible(pages + 3 * kPageSize));
+
+    // Ranges added in address order are merged as they are added.
+    batch.Unprotect(pages, kPageSize);
+    batch.Unprotect(pages + kPageSize, 2 * kPageSize);
+    EXPECT_EQ(1u, batch.range_count());
+    batch.Commit();
+    EXPECT_EQ(2u, batch.system_call_count());
+    EXPECT_TRUE(IsAccessible(pages));
+    EXPECT_TRUE(IsAccessible(pages + kPageSize));
+    EXPECT_TRUE(IsAccessible(pages + 2 * kPageSize));
+
+    // Ranges that are already in the requested state are skipped.
+    batch.Unprotect(pages, 4 * kPageSize);
+    batch.Commit();
+    EXPECT_EQ(2u, batch.system_call_count());
+
+    // Ranges with different protections aren't merged.
+    batch.Protect(pages, kPageSize);
+    batch.Unprotect(pages + kPageSize, kPageSize);
+    batch.Protect(pages + 2 * kPageSize, kPageSize);
+    EXPECT_EQ(3u, batch.range_count());
+    batch.Commit();
+    EXPECT_EQ(4u, batch.system_call_count());
+    EXPECT_TRUE(IsNotAccessible(pages));
+    EXPECT_TRUE(IsAccessible(pages + kPageSize));
+    EXPECT_TRUE(IsNotAccessible(pages + 2 * kPageSize));
+
+    // The destructor commits the pending transitions.
+    batch.Unprotect(pages, 3 * kPageSize);
+  }
+  EXPECT_TRUE(IsAccessible(pages));
+  EXPECT_TRUE(IsAccessible(pages + 2 * kPageSize));
+
+  ASSERT_EQ(TRUE, ::VirtualFree(pages, 0, MEM_RELEASE));
+}
+
 TEST_F(PageProtectionHelpersTest, ProtectionTransitions) {
   // Left and right guard pages, everything page aligned.
   EXPECT_NO_FATAL_FAILURE(TestAllProtectionTransitions(
@@ -0,0 +1,145 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Implements a quarantine made of lock-free per-processor lists.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_PER_CPU_QUARANTINE_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_PER_CPU_QUARANTINE_H_
+
+#include <windows.h>
+
+#include "syzygy/agent/asan/page_allocator.h"
+#include "syzygy/agent/asan/quarantines/size_limited_quarantine.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+// A quarantine that distributes objects among per-processor lists. Objects
+// are pushed onto a lock-free stack belonging to the processor the calling
+// thread is running on, so concurrent pushes only ever contend on an
+// interlocked operation. Pops lazily move the contents of a processor's stack
+// to a private FIFO list, so that objects are still evicted roughly in the
+// order they entered the quarantine. The global size budget is maintained by
+// SizeLimitedQuarantineImpl.
+//
+// Unlike ShardedQuarantine, this quarantine offers no locking: Lock and Unlock
+// are no-ops, and an object may be popped by another thread as soon as it has
+// been pushed. Users must not touch an object after a successful push.
+//
+// @tparam ObjectType The type of object being stored in the cache.
+// @tparam SizeFunctorType A functor for extracting the size associated with
+//     an object.
+// @tparam MaxProcessorCount The maximum number of processors that have their
+//     own list. Processors beyond this share lists with other processors.
+template<typename ObjectType,
+         typename SizeFunctorType,
+         size_t MaxProcessorCount>
+class PerCpuQuarantine
+    : public SizeLimitedQuarantineImpl<ObjectType, SizeFunctorType> {
+ public:
+  static const size_t kMaxProcessorCount = MaxProcessorCount;
+
+  // Constructor.
+  PerCpuQuarantine();
+
+  // Virtual destructor.
+  virtual ~PerCpuQuarantine() { }
+
+ protected:
+  // @name SizeLimitedQuarantineImpl implementation.
+  // @{
+  bool PushImpl(const Object& object) override;
+  bool PopImpl(Object* object) override;
+  void EmptyImpl(ObjectVector* objects) override;
+  size_t GetLockIdImpl(const Object& object) override;
+  void LockImpl(size_t id) override;
+  void UnlockImpl(size_t id) override;
+  // @}
+
+  // The internal type used for storing objects. The list entry must come
+  // first and be suitably aligned for the interlocked list functions. These
+  // live in a simple page-allocator.
+  struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) Node {
+    SLIST_ENTRY entry;
+    Node* next;
+    Object object;
+  };
+
+  // Storage for nodes. This has its own lock, but it is only used when the
+  // per-processor free lists are empty. Nodes are never returned to it.
+  typedef TypedPageAllocator<Node, 1, 32 * 1024, false> NodeCache;
+
+  // The state associated with a single processor. This is padded to a cache
+  // line to avoid false sharing between processors.
+  struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) Processor {
+    union {
+      struct {
+        // Recently pushed nodes, most recent first.
+        SLIST_HEADER incoming;
+        // Nodes that are available for reuse.
+        SLIST_HEADER free_nodes;
+        // Nodes that are next in line for eviction, oldest first. Under
+        // |draining|.
+        Node* outgoing;
+        // Acts as a try-lock granting exclusive access to |outgoing|.
+        volatile LONG draining;
+      };
+      uint8_t cache_line[64];
+    };
+  };
+
+  // @returns the index of the list used by the calling thread.
+  static size_t GetCurrentProcessorIndex();
+
+  // Gets a node, preferably from the free list of @p processor.
+  // @param processor The processor of the calling thread.
+  // @returns a node, or nullptr on failure.
+  Node* AllocateNode(Processor* processor);
+
+  // Tries to pop the oldest object of a processor list. This never blocks.
+  // @param processor The processor whose list is to be popped from.
+  // @param object Is filled in with a copy of the removed object.
+  // @returns true if an object was popped, false if the list was empty or
+  //     being popped from by another thread.
+  bool TryPopFrom(Processor* processor, Object* object);
+
+  // Moves all of the objects of a processor list to @p objects. This waits
+  // for concurrent pops to complete.
+  // @param processor The processor to be emptied.
+  // @param objects The vector receiving the objects, oldest first.
+  void EmptyProcessor(Processor* processor, ObjectVector* objects);
+
+  // Moves the contents of the incoming stack to the end of the outgoing list,
+  // reversing it in the process. Must be called with |draining| held.
+  // @param processor The processor whose lists are to be updated.
+  static void MoveIncomingToOutgoing(Processor* processor);
+
+  // The per-processor lists.
+  Processor processors_[kMaxProcessorCount];
+
+  // Backing storage for the nodes.
+  NodeCache node_cache_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PerCpuQuarantine);
+};
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#include "syzygy/agent/asan/quarantines/per_cpu_quarantine_impl.h"
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_PER_CPU_QUARANTINE_H_
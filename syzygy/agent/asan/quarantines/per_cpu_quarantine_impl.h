@@ -0,0 +1,208 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation of a per-processor quarantine. This file is not
+// meant to be included directly.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_PER_CPU_QUARANTINE_IMPL_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_PER_CPU_QUARANTINE_IMPL_H_
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+template<typename OT, typename SFT, size_t MPC>
+PerCpuQuarantine<OT, SFT, MPC>::PerCpuQuarantine() {
+  static_assert(kMaxProcessorCount >= 1, "Invalid processor count.");
+  static_assert(sizeof(Processor) == 64, "Processor must fill a cache line.");
+  for (size_t i = 0; i < kMaxProcessorCount; ++i) {
+    DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(&processors_[i]) %
+                      MEMORY_ALLOCATION_ALIGNMENT);
+    ::InitializeSListHead(&processors_[i].incoming);
+    ::InitializeSListHead(&processors_[i].free_nodes);
+    processors_[i].outgoing = nullptr;
+    processors_[i].draining = 0;
+  }
+}
+
+template<typename OT, typename SFT, size_t MPC>
+bool PerCpuQuarantine<OT, SFT, MPC>::PushImpl(const Object& object) {
+  Processor* processor = &processors_[GetCurrentProcessorIndex()];
+
+  Node* node = AllocateNode(processor);
+  if (node == nullptr)
+    return false;
+  node->object = object;
+  node->next = nullptr;
+
+  ::InterlockedPushEntrySList(&processor->incoming, &node->entry);
+  return true;
+}
+
+template<typename OT, typename SFT, size_t MPC>
+bool PerCpuQuarantine<OT, SFT, MPC>::PopImpl(Object* object) {
+  DCHECK_NE(static_cast<Object*>(nullptr), object);
+
+  // Start with the list of the current processor, as it's the most likely to
+  // be hot in the cache. Then scan the others. Lists that are busy are
+  // skipped, so make a second pass in case all of the non-empty lists were
+  // busy during the first one.
+  size_t start = GetCurrentProcessorIndex();
+  for (size_t pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < kMaxProcessorCount; ++i) {
+      size_t index = (start + i) % kMaxProcessorCount;
+      if (TryPopFrom(&processors_[index], object))
+        return true;
+    }
+  }
+
+  return false;
+}
+
+template<typename OT, typename SFT, size_t MPC>
+void PerCpuQuarantine<OT, SFT, MPC>::EmptyImpl(ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(nullptr), objects);
+  for (size_t i = 0; i < kMaxProcessorCount; ++i)
+    EmptyProcessor(&processors_[i], objects);
+}
+
+template<typename OT, typename SFT, size_t MPC>
+size_t PerCpuQuarantine<OT, SFT, MPC>::GetLockIdImpl(const Object& object) {
+  // There are no locks to be taken.
+  return 0;
+}
+
+template<typename OT, typename SFT, size_t MPC>
+void PerCpuQuarantine<OT, SFT, MPC>::LockImpl(size_t id) {
+}
+
+template<typename OT, typename SFT, size_t MPC>
+void PerCpuQuarantine<OT, SFT, MPC>::UnlockImpl(size_t id) {
+}
+
+template<typename OT, typename SFT, size_t MPC>
+size_t PerCpuQuarantine<OT, SFT, MPC>::GetCurrentProcessorIndex() {
+  return ::GetCurrentProcessorNumber() % kMaxProcessorCount;
+}
+
+template<typename OT, typename SFT, size_t MPC>
+typename PerCpuQuarantine<OT, SFT, MPC>::Node*
+PerCpuQuarantine<OT, SFT, MPC>::AllocateNode(Processor* processor) {
+  DCHECK_NE(static_cast<Processor*>(nullptr), processor);
+
+  // Nodes are returned to the free list of the processor that popped them,
+  // which is not necessarily the one that pushed them. Fall back to the node
+  // cache when this processor has run out of free nodes.
+  SLIST_ENTRY* entry = ::InterlockedPopEntrySList(&processor->free_nodes);
+  if (entry != nullptr)
+    return reinterpret_cast<Node*>(entry);
+
+  Node* node = node_cache_.Allocate(1);
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(node) %
+                    MEMORY_ALLOCATION_ALIGNMENT);
+  return node;
+}
+
+template<typename OT, typename SFT, size_t MPC>
+bool PerCpuQuarantine<OT, SFT, MPC>::TryPopFrom(Processor* processor,
+                                                Object* object) {
+  DCHECK_NE(static_cast<Processor*>(nullptr), processor);
+  DCHECK_NE(static_cast<Object*>(nullptr), object);
+
+  // Cheap early out that doesn't require any interlocked operations.
+  if (processor->outgoing == nullptr &&
+      ::QueryDepthSList(&processor->incoming) == 0) {
+    return false;
+  }
+
+  // Don't wait if another thread is already popping from this list.
+  if (::InterlockedCompareExchange(&processor->draining, 1, 0) != 0)
+    return false;
+
+  if (processor->outgoing == nullptr)
+    MoveIncomingToOutgoing(processor);
+  Node* node = processor->outgoing;
+  if (node != nullptr)
+    processor->outgoing = node->next;
+
+  ::InterlockedExchange(&processor->draining, 0);
+
+  if (node == nullptr)
+    return false;
+
+  *object = node->object;
+  Processor* current = &processors_[GetCurrentProcessorIndex()];
+  ::InterlockedPushEntrySList(&current->free_nodes, &node->entry);
+  return true;
+}
+
+template<typename OT, typename SFT, size_t MPC>
+void PerCpuQuarantine<OT, SFT, MPC>::EmptyProcessor(Processor* processor,
+                                                    ObjectVector* objects) {
+  DCHECK_NE(static_cast<Processor*>(nullptr), processor);
+  DCHECK_NE(static_cast<ObjectVector*>(nullptr), objects);
+
+  // This is rare, so simply wait for concurrent pops to complete.
+  while (::InterlockedCompareExchange(&processor->draining, 1, 0) != 0)
+    ::SwitchToThread();
+
+  MoveIncomingToOutgoing(processor);
+  Node* node = processor->outgoing;
+  processor->outgoing = nullptr;
+
+  ::InterlockedExchange(&processor->draining, 0);
+
+  while (node != nullptr) {
+    objects->push_back(node->object);
+    Node* next_node = node->next;
+    ::InterlockedPushEntrySList(&processor->free_nodes, &node->entry);
+    node = next_node;
+  }
+}
+
+template<typename OT, typename SFT, size_t MPC>
+void PerCpuQuarantine<OT, SFT, MPC>::MoveIncomingToOutgoing(
+    Processor* processor) {
+  DCHECK_NE(static_cast<Processor*>(nullptr), processor);
+  DCHECK_EQ(1, processor->draining);
+
+  // The incoming stack is most recent first, so reverse it.
+  SLIST_ENTRY* entry = ::InterlockedFlushSList(&processor->incoming);
+  Node* reversed = nullptr;
+  while (entry != nullptr) {
+    Node* node = reinterpret_cast<Node*>(entry);
+    entry = entry->Next;
+    node->next = reversed;
+    reversed = node;
+  }
+
+  if (reversed == nullptr)
+    return;
+
+  // Append the reversed stack at the end of the outgoing list.
+  if (processor->outgoing == nullptr) {
+    processor->outgoing = reversed;
+    return;
+  }
+  Node* tail = processor->outgoing;
+  while (tail->next != nullptr)
+    tail = tail->next;
+  tail->next = reversed;
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_PER_CPU_QUARANTINE_IMPL_H_
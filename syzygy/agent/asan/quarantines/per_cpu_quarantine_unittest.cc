@@ -0,0 +1,265 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/quarantines/per_cpu_quarantine.h"
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+namespace {
+
+struct DummyObject {
+  size_t size;
+  size_t id;
+
+  DummyObject() : size(0), id(0) { }
+  explicit DummyObject(size_t size) : size(size), id(0) { }
+  DummyObject(const DummyObject& o)
+      : size(o.size),
+        id(o.id) {
+  }
+  DummyObject& operator=(const DummyObject& o) {
+    size = o.size;
+    id = o.id;
+    return *this;
+  }
+};
+
+struct DummyObjectSizeFunctor {
+  size_t operator()(const DummyObject& o) {
+    return o.size;
+  }
+};
+
+class TestPerCpuQuarantine
+    : public PerCpuQuarantine<DummyObject, DummyObjectSizeFunctor, 4> {
+ public:
+  typedef PerCpuQuarantine<DummyObject, DummyObjectSizeFunctor, 4> Super;
+
+  using Super::kMaxProcessorCount;
+
+  size_t ProcessorCount(size_t index) {
+    return ::QueryDepthSList(&processors_[index].incoming) +
+        OutgoingCount(index);
+  }
+
+  size_t OutgoingCount(size_t index) {
+    Super::Node* node = processors_[index].outgoing;
+    size_t count = 0;
+    while (node) {
+      ++count;
+      node = node->next;
+    }
+    return count;
+  }
+};
+
+}  // namespace
+
+TEST(PerCpuQuarantineTest, FifoOrderOnASingleThread) {
+  TestPerCpuQuarantine q;
+  q.set_max_object_size(TestPerCpuQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(100);
+
+  // Pin the thread so that all objects land on the same list.
+  DWORD_PTR old_mask = ::SetThreadAffinityMask(::GetCurrentThread(), 1);
+  ASSERT_NE(0u, old_mask);
+
+  DummyObject d(1);
+  for (size_t i = 0; i < 150; ++i) {
+    d.id = i;
+    {
+      TestPerCpuQuarantine::AutoQuarantineLock lock(&q, d);
+      EXPECT_TRUE(q.Push(d).push_successful);
+    }
+  }
+  EXPECT_EQ(150u, q.GetCountForTesting());
+
+  // The oldest objects are evicted first.
+  DummyObject popped;
+  for (size_t i = 0; i < 50; ++i) {
+    EXPECT_TRUE(q.Pop(&popped).pop_successful);
+    EXPECT_EQ(i, popped.id);
+  }
+  EXPECT_FALSE(q.Pop(&popped).pop_successful);
+  EXPECT_EQ(100u, q.GetSizeForTesting());
+
+  // Objects pushed after a pop are evicted after the older ones.
+  d.id = 150;
+  EXPECT_TRUE(q.Push(d).push_successful);
+  TestPerCpuQuarantine::ObjectVector os;
+  q.Empty(&os);
+  ASSERT_EQ(101u, os.size());
+  for (size_t i = 0; i < os.size(); ++i)
+    EXPECT_EQ(50 + i, os[i].id);
+
+  ::SetThreadAffinityMask(::GetCurrentThread(), old_mask);
+}
+
+TEST(PerCpuQuarantineTest, NodesAreReused) {
+  TestPerCpuQuarantine q;
+  q.set_max_object_size(TestPerCpuQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(10);
+
+  DummyObject d(1);
+  DummyObject popped;
+  for (size_t i = 0; i < 10; ++i)
+    EXPECT_TRUE(q.Push(d).push_successful);
+  EXPECT_FALSE(q.Pop(&popped).pop_successful);
+
+  // Steady state: every push is matched by a pop, and doesn't need to grab
+  // any new memory.
+  for (size_t i = 0; i < 10000; ++i) {
+    EXPECT_TRUE(q.Push(d).push_successful);
+    EXPECT_TRUE(q.Pop(&popped).pop_successful);
+    EXPECT_EQ(10u, q.GetCountForTesting());
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < TestPerCpuQuarantine::kMaxProcessorCount; ++i)
+    total += q.ProcessorCount(i);
+  EXPECT_EQ(10u, total);
+}
+
+TEST(PerCpuQuarantineTest, StressTest) {
+  TestPerCpuQuarantine q;
+
+  // Doesn't allow the largest of objects we generate.
+  q.set_max_object_size((1 << 10) - 1);
+
+  // Is only 4 times as big as the largest element we generate.
+  q.set_max_quarantine_size(4 * (1 << 10));
+
+  for (size_t i = 0; i < 1000000; ++i) {
+    // Generates a logarithmic distribution of element sizes.
+    uint32_t logsize = (1 << rand() % 11);
+    uint32_t size = (rand() & (logsize - 1)) | logsize;
+    DummyObject d(size);
+
+    size_t old_size = q.GetSizeForTesting();
+    size_t old_count = q.GetCountForTesting();
+    if (size > q.max_object_size()) {
+      EXPECT_FALSE(q.Push(d).push_successful);
+      EXPECT_EQ(old_size, q.GetSizeForTesting());
+      EXPECT_EQ(old_count, q.GetCountForTesting());
+    } else {
+      EXPECT_TRUE(q.Push(d).push_successful);
+      EXPECT_EQ(old_size + size, q.GetSizeForTesting());
+      EXPECT_EQ(old_count + 1, q.GetCountForTesting());
+    }
+
+    DummyObject popped;
+    while (q.GetSizeForTesting() > q.max_quarantine_size()) {
+      old_size = q.GetSizeForTesting();
+      old_count = q.GetCountForTesting();
+      EXPECT_TRUE(q.Pop(&popped).pop_successful);
+      EXPECT_EQ(old_size - popped.size, q.GetSizeForTesting());
+      EXPECT_EQ(old_count - 1, q.GetCountForTesting());
+    }
+    EXPECT_FALSE(q.Pop(&popped).pop_successful);
+  }
+
+  size_t old_size = q.GetSizeForTesting();
+  size_t old_count = q.GetCountForTesting();
+  TestPerCpuQuarantine::ObjectVector os;
+  q.Empty(&os);
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  EXPECT_EQ(0u, q.GetCountForTesting());
+  EXPECT_EQ(old_count, os.size());
+  size_t emptied_size = 0;
+  for (size_t i = 0; i < os.size(); ++i)
+    emptied_size += os[i].size;
+  EXPECT_EQ(old_size, emptied_size);
+}
+
+namespace {
+
+// Pushes uniquely identified objects into a quarantine, popping whatever
+// overflows.
+class QuarantineThread : public base::SimpleThread {
+ public:
+  QuarantineThread(TestPerCpuQuarantine* quarantine, size_t first_id)
+      : base::SimpleThread("QuarantineThread"),
+        quarantine_(quarantine),
+        first_id_(first_id) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < kPushCount; ++i) {
+      DummyObject d(1);
+      d.id = first_id_ + i;
+      ASSERT_TRUE(quarantine_->Push(d).push_successful);
+
+      DummyObject popped;
+      while (quarantine_->GetSizeForTesting() >
+                 quarantine_->max_quarantine_size() &&
+             quarantine_->Pop(&popped).pop_successful) {
+        popped_.push_back(popped.id);
+      }
+    }
+  }
+
+  static const size_t kPushCount = 100000;
+
+  std::vector<size_t> popped_;
+
+ private:
+  TestPerCpuQuarantine* quarantine_;
+  size_t first_id_;
+};
+
+}  // namespace
+
+TEST(PerCpuQuarantineTest, MultipleThreads) {
+  TestPerCpuQuarantine q;
+  q.set_max_object_size(TestPerCpuQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(1000);
+
+  static const size_t kThreadCount = 4;
+  std::vector<std::unique_ptr<QuarantineThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads.push_back(std::unique_ptr<QuarantineThread>(
+        new QuarantineThread(&q, i * QuarantineThread::kPushCount)));
+  }
+  for (auto& thread : threads)
+    thread->Start();
+  for (auto& thread : threads)
+    thread->Join();
+
+  // Every object that was pushed comes out exactly once.
+  std::set<size_t> ids;
+  for (auto& thread : threads) {
+    for (size_t id : thread->popped_)
+      EXPECT_TRUE(ids.insert(id).second);
+  }
+  TestPerCpuQuarantine::ObjectVector os;
+  q.Empty(&os);
+  for (const auto& o : os)
+    EXPECT_TRUE(ids.insert(o.id).second);
+  EXPECT_EQ(kThreadCount * QuarantineThread::kPushCount, ids.size());
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  EXPECT_EQ(0u, q.GetCountForTesting());
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,124 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Implements a quarantine segregated by object size.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_CLASS_QUARANTINE_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_CLASS_QUARANTINE_H_
+
+#include "base/atomicops.h"
+#include "base/synchronization/lock.h"
+#include "syzygy/agent/asan/page_allocator.h"
+#include "syzygy/agent/asan/quarantines/size_limited_quarantine.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+// A quarantine that keeps a separate FIFO list per size class, each with its
+// own lock and its own share of the quarantine size as its budget. Smaller
+// size classes get larger budgets: size class i gets a share proportional to
+// kSizeClassCount - i. Evictions are taken from the class that is the
+// furthest over its budget, preferring the larger classes on ties. A few
+// large objects thus can't flush out the many small ones, which are kept for
+// longer.
+//
+// Size classes grow by a factor of 4, from objects of up to 64 bytes to
+// objects of more than 256KB.
+//
+// @tparam ObjectType The type of object being stored in the cache.
+// @tparam SizeFunctorType A functor for extracting the size associated with
+//     an object.
+template<typename ObjectType, typename SizeFunctorType>
+class SizeClassQuarantine
+    : public SizeLimitedQuarantineImpl<ObjectType, SizeFunctorType> {
+ public:
+  // The number of size classes.
+  static const size_t kSizeClassCount = 8;
+
+  // The largest object in the first size class.
+  static const size_t kSmallestSizeClassLimit = 64;
+
+  SizeClassQuarantine();
+
+  // Virtual destructor.
+  virtual ~SizeClassQuarantine() { }
+
+  // @returns the size class of an object of the given size.
+  // @param size The size of the object.
+  static size_t GetSizeClass(size_t size);
+
+  // @returns the size budget of a size class.
+  // @param size_class The size class to query.
+  size_t GetSizeClassBudget(size_t size_class) const;
+
+  // @returns the total size of the objects in a size class.
+  // @param size_class The size class to query.
+  size_t GetSizeClassSizeForTesting(size_t size_class) const;
+
+ protected:
+  // @name SizeLimitedQuarantineImpl implementation.
+  // @{
+  bool PushImpl(const Object& object) override;
+  bool PopImpl(Object* object) override;
+  void EmptyImpl(ObjectVector* objects) override;
+  size_t GetLockIdImpl(const Object& object) override;
+  void LockImpl(size_t id) override;
+  void UnlockImpl(size_t id) override;
+  // @}
+
+  // @returns the size class to evict from, being the non-empty one furthest
+  //     over its budget, or kSizeClassCount if they are all empty.
+  size_t PickVictimSizeClass() const;
+
+  // The internal type used for storing objects. This augments them with a
+  // 'next' pointer for chaining them together in the cache.
+  struct Node {
+    Object object;
+    Node* next;
+  };
+
+  // A simple page allocator that can only allocate individual nodes. See
+  // ShardedQuarantine for the choice of page size.
+  typedef TypedPageAllocator<Node, 1, 32 * 1024, false> NodeCache;
+
+  // Linked lists containing quarantined objects, one per size class, each
+  // under the corresponding locks_ entry. Objects are inserted at the tail,
+  // and removed from the head.
+  Node* heads_[kSizeClassCount];
+  Node* tails_[kSizeClassCount];
+
+  // The total size of the objects in each size class. Only modified under
+  // the corresponding locks_ entry, but read without it when picking a class
+  // to evict from.
+  base::subtle::AtomicWord sizes_[kSizeClassCount];
+
+  // Storage for nodes, one per size class. Each is under its own internal
+  // lock.
+  NodeCache node_caches_[kSizeClassCount];
+
+  // Locks, one per linked list.
+  base::Lock locks_[kSizeClassCount];
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SizeClassQuarantine);
+};
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#include "syzygy/agent/asan/quarantines/size_class_quarantine_impl.h"
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_CLASS_QUARANTINE_H_
@@ -0,0 +1,209 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation of a size class quarantine. This file is not
+// meant to be included directly.
+
+#ifndef SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_CLASS_QUARANTINE_IMPL_H_
+#define SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_CLASS_QUARANTINE_IMPL_H_
+
+#include "string.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+template<typename OT, typename SFT>
+SizeClassQuarantine<OT, SFT>::SizeClassQuarantine() {
+  static_assert(kSizeClassCount >= 1, "Invalid size class count.");
+  ::memset(heads_, 0, sizeof(heads_));
+  ::memset(tails_, 0, sizeof(tails_));
+  ::memset(sizes_, 0, sizeof(sizes_));
+}
+
+template<typename OT, typename SFT>
+size_t SizeClassQuarantine<OT, SFT>::GetSizeClass(size_t size) {
+  size_t size_class = 0;
+  size_t limit = kSmallestSizeClassLimit;
+  while (size > limit && size_class + 1 < kSizeClassCount) {
+    ++size_class;
+    limit *= 4;
+  }
+  return size_class;
+}
+
+template<typename OT, typename SFT>
+size_t SizeClassQuarantine<OT, SFT>::GetSizeClassBudget(
+    size_t size_class) const {
+  DCHECK_LT(size_class, kSizeClassCount);
+  if (this->max_quarantine_size_ == this->kUnboundedSize)
+    return this->kUnboundedSize;
+
+  // Size class i gets kSizeClassCount - i shares.
+  static const size_t kTotalShares =
+      kSizeClassCount * (kSizeClassCount + 1) / 2;
+  return this->max_quarantine_size_ / kTotalShares *
+         (kSizeClassCount - size_class);
+}
+
+template<typename OT, typename SFT>
+size_t SizeClassQuarantine<OT, SFT>::GetSizeClassSizeForTesting(
+    size_t size_class) const {
+  DCHECK_LT(size_class, kSizeClassCount);
+  return base::subtle::NoBarrier_Load(&sizes_[size_class]);
+}
+
+template<typename OT, typename SFT>
+bool SizeClassQuarantine<OT, SFT>::PushImpl(const Object& object) {
+  size_t size = this->size_functor_(object);
+  size_t size_class = GetSizeClass(size);
+  // Make sure the corresponding lock is held.
+  locks_[size_class].AssertAcquired();
+
+  Node* node = node_caches_[size_class].Allocate(1);
+  if (node == NULL)
+    return false;
+  node->object = object;
+  node->next = NULL;
+
+  // Append the node to the tail of this size class.
+  if (tails_[size_class] != NULL) {
+    DCHECK_NE(static_cast<Node*>(NULL), heads_[size_class]);
+    tails_[size_class]->next = node;
+    tails_[size_class] = node;
+  } else {
+    DCHECK_EQ(static_cast<Node*>(NULL), heads_[size_class]);
+    heads_[size_class] = node;
+    tails_[size_class] = node;
+  }
+  base::subtle::NoBarrier_Store(
+      &sizes_[size_class],
+      base::subtle::NoBarrier_Load(&sizes_[size_class]) + size);
+
+  return true;
+}
+
+template<typename OT, typename SFT>
+size_t SizeClassQuarantine<OT, SFT>::PickVictimSizeClass() const {
+  // The sizes are read without the locks, so this is only a best guess. The
+  // caller rechecks that the class is non-empty under its lock.
+  size_t victim = kSizeClassCount;
+  size_t victim_size = 0;
+  size_t victim_budget = 0;
+  for (size_t i = kSizeClassCount; i > 0; --i) {
+    size_t size_class = i - 1;
+    size_t size = base::subtle::NoBarrier_Load(&sizes_[size_class]);
+    if (size == 0)
+      continue;
+    size_t budget = GetSizeClassBudget(size_class);
+
+    // Compare the excesses over budget without going negative:
+    // size - budget > victim_size - victim_budget.
+    if (victim == kSizeClassCount ||
+        size + victim_budget > victim_size + budget) {
+      victim = size_class;
+      victim_size = size;
+      victim_budget = budget;
+    }
+  }
+  return victim;
+}
+
+template<typename OT, typename SFT>
+bool SizeClassQuarantine<OT, SFT>::PopImpl(Object* object) {
+  DCHECK_NE(static_cast<Object*>(NULL), object);
+
+  // Extract a node from the victim size class. If it has been emptied in the
+  // meantime then scan from the largest size class until finding a non-empty
+  // one.
+  Node* node = NULL;
+  size_t size_class = PickVictimSizeClass();
+  if (size_class == kSizeClassCount)
+    size_class = kSizeClassCount - 1;
+  size_t orig_size_class = size_class;
+  while (true) {
+    base::AutoLock lock(locks_[size_class]);
+    node = heads_[size_class];
+    if (node == NULL) {
+      size_class = (size_class + kSizeClassCount - 1) % kSizeClassCount;
+
+      // If there's no non-empty size class then this means that another
+      // thread emptied out all the lists while we were in this function.
+      if (size_class == orig_size_class)
+        return false;
+      continue;
+    }
+
+    // We've found an element to evict so we can stop looking.
+    heads_[size_class] = node->next;
+    if (heads_[size_class] == NULL)
+      tails_[size_class] = NULL;
+    base::subtle::NoBarrier_Store(
+        &sizes_[size_class],
+        base::subtle::NoBarrier_Load(&sizes_[size_class]) -
+            this->size_functor_(node->object));
+    break;
+  }
+  DCHECK_NE(static_cast<Node*>(NULL), node);
+
+  *object = node->object;
+  node_caches_[size_class].Free(node, 1);
+
+  return true;
+}
+
+template<typename OT, typename SFT>
+void SizeClassQuarantine<OT, SFT>::EmptyImpl(ObjectVector* objects) {
+  DCHECK_NE(static_cast<ObjectVector*>(NULL), objects);
+
+  // Iterate over each size class and add the objects to the vector.
+  for (size_t i = 0; i < kSizeClassCount; ++i) {
+    base::AutoLock lock(locks_[i]);
+
+    Node* node = heads_[i];
+    while (node) {
+      objects->push_back(node->object);
+      Node* next_node = node->next;
+      node_caches_[i].Free(node, 1);
+      node = next_node;
+    }
+    heads_[i] = NULL;
+    tails_[i] = NULL;
+    base::subtle::NoBarrier_Store(&sizes_[i], 0);
+  }
+}
+
+template<typename OT, typename SFT>
+size_t SizeClassQuarantine<OT, SFT>::GetLockIdImpl(const Object& object) {
+  return GetSizeClass(this->size_functor_(object));
+}
+
+template<typename OT, typename SFT>
+void SizeClassQuarantine<OT, SFT>::LockImpl(size_t id) {
+  DCHECK_LT(id, kSizeClassCount);
+  locks_[id].Acquire();
+}
+
+template<typename OT, typename SFT>
+void SizeClassQuarantine<OT, SFT>::UnlockImpl(size_t id) {
+  DCHECK_LT(id, kSizeClassCount);
+  locks_[id].AssertAcquired();
+  locks_[id].Release();
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_QUARANTINES_SIZE_CLASS_QUARANTINE_IMPL_H_
@@ -0,0 +1,186 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/quarantines/size_class_quarantine.h"
+
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace asan {
+namespace quarantines {
+
+namespace {
+
+struct DummyObject {
+  size_t size;
+
+  DummyObject() : size(0) { }
+  explicit DummyObject(size_t size) : size(size) { }
+};
+
+struct DummyObjectSizeFunctor {
+  size_t operator()(const DummyObject& o) {
+    return o.size;
+  }
+};
+
+typedef SizeClassQuarantine<DummyObject, DummyObjectSizeFunctor>
+    TestSizeClassQuarantine;
+
+void PushObject(TestSizeClassQuarantine* q, size_t size) {
+  DummyObject d(size);
+  TestSizeClassQuarantine::AutoQuarantineLock lock(q, d);
+  EXPECT_TRUE(q->Push(d).push_successful);
+}
+
+}  // namespace
+
+TEST(SizeClassQuarantineTest, GetSizeClass) {
+  EXPECT_EQ(0u, TestSizeClassQuarantine::GetSizeClass(0));
+  EXPECT_EQ(0u, TestSizeClassQuarantine::GetSizeClass(64));
+  EXPECT_EQ(1u, TestSizeClassQuarantine::GetSizeClass(65));
+  EXPECT_EQ(1u, TestSizeClassQuarantine::GetSizeClass(256));
+  EXPECT_EQ(2u, TestSizeClassQuarantine::GetSizeClass(257));
+  EXPECT_EQ(TestSizeClassQuarantine::kSizeClassCount - 1,
+            TestSizeClassQuarantine::GetSizeClass(256 * 1024 + 1));
+  EXPECT_EQ(TestSizeClassQuarantine::kSizeClassCount - 1,
+            TestSizeClassQuarantine::GetSizeClass(SIZE_MAX));
+}
+
+TEST(SizeClassQuarantineTest, Budgets) {
+  TestSizeClassQuarantine q;
+  EXPECT_EQ(TestSizeClassQuarantine::kUnboundedSize,
+            q.GetSizeClassBudget(0));
+
+  q.set_max_quarantine_size(36 * 1000);
+  size_t total_budget = 0;
+  for (size_t i = 0; i < TestSizeClassQuarantine::kSizeClassCount; ++i) {
+    size_t budget = q.GetSizeClassBudget(i);
+    if (i > 0)
+      EXPECT_GT(q.GetSizeClassBudget(i - 1), budget);
+    total_budget += budget;
+  }
+  EXPECT_EQ(8000u, q.GetSizeClassBudget(0));
+  EXPECT_EQ(1000u, q.GetSizeClassBudget(7));
+  EXPECT_EQ(q.max_quarantine_size(), total_budget);
+}
+
+TEST(SizeClassQuarantineTest, LargeObjectsAreEvictedFirst) {
+  TestSizeClassQuarantine q;
+  q.set_max_object_size(TestSizeClassQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(36 * 1024);
+
+  // Fill the budget of the smallest size class with small objects, which
+  // are older than the large ones.
+  for (size_t i = 0; i < 8 * 1024 / 32; ++i)
+    PushObject(&q, 32);
+  size_t small_size = q.GetSizeClassSizeForTesting(0);
+  EXPECT_EQ(8u * 1024, small_size);
+
+  // Overflow the quarantine with large objects.
+  while (q.GetSizeForTesting() <= q.max_quarantine_size())
+    PushObject(&q, 2000);
+
+  // Only large objects get evicted.
+  DummyObject popped;
+  while (q.Pop(&popped).pop_successful)
+    EXPECT_EQ(2000u, popped.size);
+  EXPECT_EQ(small_size, q.GetSizeClassSizeForTesting(0));
+  EXPECT_GE(q.max_quarantine_size(), q.GetSizeForTesting());
+}
+
+TEST(SizeClassQuarantineTest, OverBudgetClassIsEvictedFirst) {
+  TestSizeClassQuarantine q;
+  q.set_max_object_size(TestSizeClassQuarantine::kUnboundedSize);
+  q.set_max_quarantine_size(36 * 1024);
+
+  // Overflow the quarantine with small objects alone. These get evicted in
+  // FIFO order, as no other class is over its budget.
+  PushObject(&q, 2000);
+  while (q.GetSizeForTesting() <= q.max_quarantine_size())
+    PushObject(&q, 32);
+
+  DummyObject popped;
+  EXPECT_TRUE(q.Pop(&popped).pop_successful);
+  EXPECT_EQ(32u, popped.size);
+  EXPECT_EQ(2000u, q.GetSizeClassSizeForTesting(
+      TestSizeClassQuarantine::GetSizeClass(2000)));
+}
+
+TEST(SizeClassQuarantineTest, StressTest) {
+  TestSizeClassQuarantine q;
+
+  // Doesn't allow the largest of objects we generate.
+  q.set_max_object_size((1 << 16) - 1);
+  q.set_max_quarantine_size(4 * (1 << 16));
+
+  for (size_t i = 0; i < 100000; ++i) {
+    // Generates a logarithmic distribution of element sizes.
+    uint32_t logsize = (1 << rand() % 17);
+    uint32_t size = (rand() & (logsize - 1)) | logsize;
+    DummyObject d(size);
+
+    size_t old_size = q.GetSizeForTesting();
+    size_t old_count = q.GetCountForTesting();
+    {
+      TestSizeClassQuarantine::AutoQuarantineLock lock(&q, d);
+      EXPECT_EQ(size <= q.max_object_size(), q.Push(d).push_successful);
+    }
+    if (size > q.max_object_size()) {
+      EXPECT_EQ(old_size, q.GetSizeForTesting());
+      EXPECT_EQ(old_count, q.GetCountForTesting());
+    } else {
+      EXPECT_EQ(old_size + size, q.GetSizeForTesting());
+      EXPECT_EQ(old_count + 1, q.GetCountForTesting());
+    }
+
+    DummyObject popped;
+    while (q.GetSizeForTesting() > q.max_quarantine_size())
+      EXPECT_TRUE(q.Pop(&popped).pop_successful);
+    EXPECT_FALSE(q.Pop(&popped).pop_successful);
+
+    // The per class sizes are consistent with the total.
+    size_t class_size = 0;
+    for (size_t j = 0; j < TestSizeClassQuarantine::kSizeClassCount; ++j)
+      class_size += q.GetSizeClassSizeForTesting(j);
+    EXPECT_EQ(q.GetSizeForTesting(), class_size);
+  }
+
+  size_t old_size = q.GetSizeForTesting();
+  size_t old_count = q.GetCountForTesting();
+  TestSizeClassQuarantine::ObjectVector os;
+  q.Empty(&os);
+  EXPECT_EQ(0u, q.GetSizeForTesting());
+  EXPECT_EQ(0u, q.GetCountForTesting());
+  EXPECT_EQ(old_count, os.size());
+  size_t emptied_size = 0;
+  for (size_t i = 0; i < os.size(); ++i)
+    emptied_size += os[i].size;
+  EXPECT_EQ(old_size, emptied_size);
+  for (size_t i = 0; i < TestSizeClassQuarantine::kSizeClassCount; ++i)
+    EXPECT_EQ(0u, q.GetSizeClassSizeForTesting(i));
+}
+
+TEST(SizeClassQuarantineTest, LockIdIsSizeClass) {
+  TestSizeClassQuarantine q;
+  DummyObject small(10);
+  DummyObject large(100000);
+  EXPECT_EQ(0u, q.GetLockId(small));
+  EXPECT_EQ(TestSizeClassQuarantine::GetSizeClass(100000),
+            q.GetLockId(large));
+}
+
+}  // namespace quarantines
+}  // namespace asan
+}  // namespace agent
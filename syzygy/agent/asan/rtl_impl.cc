@@ -24,6 +24,7 @@
 #include "syzygy/agent/asan/heap_manager.h"
 #include "syzygy/agent/asan/rtl_utils.h"
 #include "syzygy/agent/asan/runtime.h"
+#include "syzygy/agent/asan/runtime_statistics.h"
 #include "syzygy/agent/asan/shadow.h"
 #include "syzygy/agent/asan/windows_heap_adapter.h"
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
@@ -263,4 +264,12 @@ void WINAPI asan_InitializeCrashReporter() {
   asan_runtime->InitializeCrashReporter();
 }
 
+BOOL WINAPI asan_GetRuntimeStatistics(
+    agent::asan::AsanRuntimeStatistics* statistics) {
+  if (statistics == nullptr)
+    return FALSE;
+  asan_runtime->GetStatistics(statistics);
+  return TRUE;
+}
+
 }  // extern "C"
@@ -23,6 +23,7 @@ namespace asan {
 
 class AsanRuntime;
 struct AsanErrorInfo;
+struct AsanRuntimeStatistics;
 
 // Initialize the Asan runtime library global variables.
 // @param runtime The Asan runtime manager.
@@ -136,6 +137,14 @@ int asan_CrashForException(EXCEPTION_POINTERS* exception);
 //   syzyasan_init_crash_reporter();
 void WINAPI asan_InitializeCrashReporter();
 
+// Gets the statistics describing the activity of the runtime, to help tune
+// its parameters. The same statistics are logged when the process exits.
+// @param statistics Will receive the statistics. Its |size| field is set to
+//     the size of the structure filled in by the runtime.
+// @returns TRUE on success, FALSE if @p statistics is null.
+BOOL WINAPI asan_GetRuntimeStatistics(
+    agent::asan::AsanRuntimeStatistics* statistics);
+
 }  // extern "C"
 
 #endif  // SYZYGY_AGENT_ASAN_RTL_IMPL_H_
@@ -172,6 +172,27 @@ class AsanRtlImplTestCrashReporterInitialization : public AsanRtlImplTest {
 
 }  // namespace
 
+TEST_F(AsanRtlImplTest, GetRuntimeStatistics) {
+  EXPECT_FALSE(asan_GetRuntimeStatistics(nullptr));
+
+  AsanRuntimeStatistics before = {};
+  ASSERT_TRUE(asan_GetRuntimeStatistics(&before));
+  EXPECT_EQ(sizeof(before), before.size);
+
+  HANDLE heap = asan_HeapCreate(0, 0, 0);
+  ASSERT_NE(static_cast<HANDLE>(nullptr), heap);
+  void* alloc = asan_HeapAlloc(heap, 0, 100);
+  ASSERT_NE(static_cast<void*>(nullptr), alloc);
+  EXPECT_TRUE(asan_HeapFree(heap, 0, alloc));
+  EXPECT_TRUE(asan_HeapDestroy(heap));
+
+  AsanRuntimeStatistics after = {};
+  ASSERT_TRUE(asan_GetRuntimeStatistics(&after));
+  EXPECT_LT(before.allocations, after.allocations);
+  EXPECT_LT(before.frees, after.frees);
+  EXPECT_LT(before.stack_cache_requests, after.stack_cache_requests);
+}
+
 TEST_F(AsanRtlImplTestCrashReporterInitialization, InitializeCrashReporter) {
   EXPECT_FALSE(asan_runtime_.crash_reporter_initialized());
   asan_InitializeCrashReporter();
@@ -172,20 +172,24 @@ void TestMemoryRange(Shadow* shadow,
   if (!shadow || size == 0U)
     return;
 
-  // TODO(sebmarchand): This approach is pretty limited because it only checks
-  //     if the first and the last elements are accessible. Once we have the
-  //     plumbing in place we should benchmark a check that looks at each
-  //     address to be touched (via the shadow memory, 8 bytes at a time).
-  if (!shadow->IsAccessible(memory) ||
-      !shadow->IsAccessible(memory + size - 1)) {
-    const void* location = shadow->FindFirstPoisonedByte(memory, size);
-    // If this check hits, either you've lucked on a time-of-check race, and
-    // there's a genuine bug in the call stack above, or else there's a bug
-    // in the runtime.
-    CHECK(location != nullptr);
-
-    ReportBadAccess(location, access_mode);
+  // Most bad accesses overflow one end of the range, and checking the end
+  // points is cheap. Only then is the rest of the range checked, with the
+  // vectorized range check, which uses the shadow summary to skip over large
+  // accessible ranges. The first poisoned byte only needs to be located once
+  // the range is known to be bad.
+  if (shadow->IsAccessible(memory) &&
+      shadow->IsAccessible(memory + size - 1) &&
+      shadow->IsRangeAccessible(memory, size)) {
+    return;
   }
+
+  const void* location = shadow->FindFirstPoisonedByte(memory, size);
+  // If this check hits, either you've lucked on a time-of-check race, and
+  // there's a genuine bug in the call stack above, or else there's a bug
+  // in the runtime.
+  CHECK(location != nullptr);
+
+  ReportBadAccess(location, access_mode);
 }
 
 }  // namespace asan
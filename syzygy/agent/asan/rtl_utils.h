@@ -82,7 +82,8 @@ void ReportBadMemoryAccess(const void* location,
 // @param access_mode The mode of the access.
 void ReportBadAccess(const void* location, AccessMode access_mode);
 
-// Test that a memory range is accessible. Report an error if it's not.
+// Test that a memory range is accessible. Every byte of the range is checked,
+// and an error is reported on the first one that isn't accessible.
 // @param shadow The shadow memory to use.
 // @param memory The pointer to the beginning of the memory range that we want
 //     to check.
@@ -146,6 +146,58 @@ TEST(AsanRtlUtilsTest, TestMemoryRange) {
   runtime.shadow()->Unpoison(test_buffer.get(), kTestBufferSize);
 }
 
+TEST(AsanRtlUtilsTest, TestMemoryRangeChecksTheWholeRange) {
+  TestAsanRuntime runtime;
+  SetAsanRuntimeInstance(&runtime);
+  AccessMode access_mode = ASAN_WRITE_ACCESS;
+  const size_t kTestBufferSize = 64 * 1024;
+  std::unique_ptr<uint8_t[]> test_buffer(new uint8_t[kTestBufferSize]);
+
+  // Poison a range in the middle of the buffer, leaving both ends accessible.
+  // Heap allocations are at least kShadowRatio aligned.
+  uint8_t* poisoned = test_buffer.get() + kTestBufferSize / 2 + kShadowRatio;
+  runtime.shadow()->Poison(poisoned, 2 * kShadowRatio, kUserRedzoneMarker);
+
+  memory_error_detected = false;
+  TestMemoryRange(runtime.shadow(), test_buffer.get(), kTestBufferSize / 4,
+                  access_mode);
+  EXPECT_FALSE(memory_error_detected);
+
+  TestMemoryRange(runtime.shadow(), test_buffer.get(), kTestBufferSize,
+                  access_mode);
+  EXPECT_TRUE(memory_error_detected);
+  EXPECT_EQ(poisoned, last_error_info.location);
+  EXPECT_EQ(access_mode, last_error_info.access_mode);
+
+  runtime.shadow()->Unpoison(test_buffer.get(), kTestBufferSize);
+}
+
+TEST(AsanRtlUtilsTest, TestMemoryRangeChecksTheMiddleOfSmallRanges) {
+  TestAsanRuntime runtime;
+  SetAsanRuntimeInstance(&runtime);
+  AccessMode access_mode = ASAN_READ_ACCESS;
+  const size_t kTestBufferSize = 256;
+  std::unique_ptr<uint8_t[]> test_buffer(new uint8_t[kTestBufferSize]);
+
+  // A range this small is checked without the shadow summary. Both ends of
+  // the range are accessible, so checking the end points alone misses this.
+  uint8_t* poisoned = test_buffer.get() + 8 * kShadowRatio;
+  runtime.shadow()->Poison(poisoned, kShadowRatio, kUserRedzoneMarker);
+
+  memory_error_detected = false;
+  TestMemoryRange(runtime.shadow(), test_buffer.get(), 8 * kShadowRatio,
+                  access_mode);
+  EXPECT_FALSE(memory_error_detected);
+
+  TestMemoryRange(runtime.shadow(), test_buffer.get(), kTestBufferSize,
+                  access_mode);
+  EXPECT_TRUE(memory_error_detected);
+  EXPECT_EQ(poisoned, last_error_info.location);
+  EXPECT_EQ(access_mode, last_error_info.access_mode);
+
+  runtime.shadow()->Unpoison(test_buffer.get(), kTestBufferSize);
+}
+
 TEST(AsanRtlUtilsTest, TestStructure) {
   TestAsanRuntime runtime;
   SetAsanRuntimeInstance(&runtime);
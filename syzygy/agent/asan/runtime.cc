@@ -89,6 +89,10 @@ static_assert((kAsanStatus >> 16) == 0, "Too many status bits.");
 static_assert((kAsanException & (3 << 27)) == 0,
               "Bits 27 and 28 should be clear.");
 
+// The time given to a parallel heap check. This keeps a crash on a huge heap
+// from being reported so late that the user has already killed the process.
+const int kHeapCheckerTimeBudgetMs = 5000;
+
 // Raises an exception, first wrapping it an Asan specific exception. This
 // indicates to our unhandled exception handler that it doesn't need to
 // process the exception.
@@ -375,8 +379,16 @@ size_t MaxSafeAllocaSize() {
         "SyzyASAN: Heap checker enabled, processing exception.");           \
     AutoHeapManagerLock lock((runtime)->heap_manager_.get());               \
     HeapChecker heap_checker((runtime)->shadow());                          \
+    heap_checker.EnableParallelWalk(                                        \
+        (runtime)->params_.heap_checker_thread_count,                       \
+        base::TimeDelta::FromMilliseconds(kHeapCheckerTimeBudgetMs));       \
     HeapChecker::CorruptRangesVector corrupt_ranges;                        \
     heap_checker.IsHeapCorrupt(&corrupt_ranges);                            \
+    if (!heap_checker.walk_completed()) {                                   \
+      runtime_->logger_->Write(                                             \
+          "SyzyASAN: Heap checker ran out of time, the heap was only "      \
+          "partially checked.");                                            \
+    }                                                                       \
     size_t size = (runtime)->CalculateCorruptHeapInfoSize(corrupt_ranges);  \
     void* buffer = NULL;                                                    \
     if (size > 0) {                                                         \
@@ -474,14 +486,14 @@ bool AsanRuntime::SetUp(const std::wstring& flags_command_line) {
   DCHECK(!runtime_);
   runtime_ = this;
 
-  // Setup the shadow memory first. If this fails the dynamic runtime can
-  // safely disable the instrumentation.
-  if (!SetUpShadow())
+  // Parse any flags set via the environment variable. This logs failure for
+  // us. This comes first as the flags decide how the shadow is backed.
+  if (!::common::ParseAsanParameters(flags_command_line, &params_))
     return false;
 
-  // Parse and propagate any flags set via the environment variable. This logs
-  // failure for us.
-  if (!::common::ParseAsanParameters(flags_command_line, &params_))
+  // Setup the shadow memory next. If this fails the dynamic runtime can
+  // safely disable the instrumentation.
+  if (!SetUpShadow())
     return false;
 
   // Initialize the command-line structures. This is needed so that
@@ -539,8 +551,10 @@ void AsanRuntime::TearDown() {
 
   // The WindowsHeapAdapter will only have been initialized if the heap manager
   // was successfully created and initialized.
-  if (heap_manager_.get() != nullptr)
+  if (heap_manager_.get() != nullptr) {
+    LogStatistics();
     WindowsHeapAdapter::TearDown();
+  }
   TearDownHeapManager();
   TearDownStackCache();
   TearDownLogger();
@@ -565,6 +579,9 @@ void AsanRuntime::OnErrorImpl(AsanErrorInfo* error_info) {
 
   LogAsanErrorInfo(error_info);
 
+  // Make sure that nothing logged so far is lost if the process goes down.
+  logger_->Flush();
+
   if (params_.minidump_on_failure) {
     DCHECK(logger_.get() != NULL);
     std::string protobuf;
@@ -589,6 +606,13 @@ void AsanRuntime::OnError(AsanErrorInfo* error_info) {
   // from being modified while processing the error.
   ::common::AutoRecursiveLock lock(block_protect_lock);
 
+  // The poisoning of internal memory may be pending, so write it before the
+  // shadow gets inspected.
+  if (memory_notifier_.get() != nullptr) {
+    static_cast<memory_notifiers::ShadowMemoryNotifier*>(
+        memory_notifier_.get())->Flush();
+  }
+
   // Unfortunately this is a giant macro, but it needs to be as it performs
   // stack allocations.
   CHECK_HEAP_CORRUPTION(this, error_info);
@@ -606,7 +630,8 @@ void AsanRuntime::SetErrorCallBack(const AsanOnErrorCallBack& callback) {
 
 bool AsanRuntime::SetUpShadow() {
   // Dynamically allocate the shadow memory.
-  shadow_.reset(new Shadow());
+  shadow_.reset(new Shadow(Shadow::RequiredLength(),
+                           params_.enable_large_page_shadow));
 
   // If the allocation fails, then return false.
   if (shadow_->shadow() == nullptr)
@@ -629,8 +654,9 @@ bool AsanRuntime::SetUpShadow() {
 }
 
 void AsanRuntime::TearDownShadow() {
-  // If this didn't successfully initialize then do nothing.
-  if (shadow_->shadow() == nullptr)
+  // If this didn't successfully initialize then do nothing. The shadow isn't
+  // even created if the flags failed to parse.
+  if (shadow_.get() == nullptr || shadow_->shadow() == nullptr)
     return;
 
   shadow_->TearDown();
@@ -714,6 +740,17 @@ bool AsanRuntime::SetUpStackCache() {
   memory_notifier_->NotifyInternalUse(stack_cache_.get(),
                                       sizeof(*stack_cache_.get()));
 
+  // The stack captures fall back to querying the OS for the modules if the
+  // cache can't be kept up to date.
+  DCHECK_EQ(static_cast<common::ModuleBoundsCache*>(nullptr),
+            module_bounds_cache_.get());
+  module_bounds_cache_.reset(new common::ModuleBoundsCache());
+  if (module_bounds_cache_->Init()) {
+    common::StackCapture::set_module_bounds_cache(module_bounds_cache_.get());
+  } else {
+    module_bounds_cache_.reset();
+  }
+
   return true;
 }
 
@@ -725,6 +762,11 @@ void AsanRuntime::TearDownStackCache() {
             memory_notifier_.get());
   DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger_.get());
 
+  if (module_bounds_cache_.get() != nullptr) {
+    common::StackCapture::set_module_bounds_cache(nullptr);
+    module_bounds_cache_.reset();
+  }
+
   stack_cache_->LogStatistics();
   memory_notifier_->NotifyReturnedToOS(stack_cache_.get(),
                                        sizeof(*stack_cache_.get()));
@@ -792,25 +834,29 @@ void AsanRuntime::PropagateParams() {
   // This function has to be kept in sync with the AsanParameters struct. These
   // checks will ensure that this is the case.
 #ifdef _WIN64
-  static_assert(sizeof(::common::AsanParameters) == 64,
+  static_assert(sizeof(::common::AsanParameters) == 76,
                 "Must propagate parameters.");
 #else
-  static_assert(sizeof(::common::AsanParameters) == 60,
+  static_assert(sizeof(::common::AsanParameters) == 72,
                 "Must propagate parameters.");
 #endif
-  static_assert(::common::kAsanParametersVersion == 15,
+  static_assert(::common::kAsanParametersVersion == 28,
                 "Must update parameters version.");
 
   // Push the configured parameter values to the appropriate endpoints.
   heap_manager_->set_parameters(params_);
+  shadow_->set_decommit_released_memory(params_.enable_shadow_decommit);
   StackCaptureCache::set_compression_reporting_period(params_.reporting_period);
   common::StackCapture::set_bottom_frames_to_skip(
       params_.bottom_frames_to_skip);
   stack_cache_->set_max_num_frames(params_.max_num_frames);
+  stack_cache_->set_compact_frames(params_.enable_compact_stack_cache);
   // ignored_stack_ids is used locally by AsanRuntime.
   logger_->set_log_as_text(params_.log_as_text);
   // exit_on_failure is used locally by AsanRuntime.
   logger_->set_minidump_on_failure(params_.minidump_on_failure);
+  if (params_.enable_buffered_logging)
+    logger_->StartBuffering();
 }
 
 size_t AsanRuntime::CalculateCorruptHeapInfoSize(
@@ -1007,6 +1053,11 @@ void AsanRuntime::AddThreadId(uint32_t thread_id) {
   thread_ids_.insert(thread_id);
 }
 
+void AsanRuntime::OnThreadExit() {
+  DCHECK(heap_manager_);
+  heap_manager_->FlushThreadLocalBlockCache();
+}
+
 bool AsanRuntime::ThreadIdIsValid(uint32_t thread_id) {
   base::AutoLock lock(thread_ids_lock_);
   return thread_ids_.find(thread_id) != thread_ids_.end();
@@ -1166,6 +1217,7 @@ LONG AsanRuntime::ExceptionFilterImpl(bool is_unhandled,
 
   // If a crash reporter is present then use it.
   if (emit_asan_error && runtime_->crash_reporter() != nullptr) {
+    runtime_->logger_->Flush();
     DumpAndCrashViaReporter(&error_info, exception);
     return EXCEPTION_CONTINUE_SEARCH;
   }
@@ -1192,6 +1244,67 @@ void AsanRuntime::DisableDeferredFreeThread() {
   heap_manager_->DisableDeferredFreeThread();
 }
 
+void AsanRuntime::GetStatistics(AsanRuntimeStatistics* statistics) {
+  DCHECK_NE(static_cast<AsanRuntimeStatistics*>(nullptr), statistics);
+  DCHECK(heap_manager_);
+  DCHECK(stack_cache_);
+
+  ::memset(statistics, 0, sizeof(*statistics));
+  statistics->size = sizeof(*statistics);
+  heap_manager_->GetStatistics(statistics);
+  stack_cache_->GetHitCounts(&statistics->stack_cache_requests,
+                             &statistics->stack_cache_hits);
+}
+
+void AsanRuntime::LogStatistics() {
+  DCHECK(logger_);
+
+  AsanRuntimeStatistics statistics = {};
+  GetStatistics(&statistics);
+
+  std::string message = base::StringPrintf(
+      "PID=%d; Allocations=%u; Frees=%u; Quarantine pushes=%u; "
+      "Quarantine pops=%u; Quarantine trims=%u; Stack cache hits=%u/%u",
+      ::GetCurrentProcessId(),
+      statistics.allocations,
+      statistics.frees,
+      statistics.quarantine_pushes,
+      statistics.quarantine_pops,
+      statistics.quarantine_trims,
+      statistics.stack_cache_hits,
+      statistics.stack_cache_requests);
+  logger_->Write(message);
+
+  // Only the non-empty size classes are logged, by their upper bound. The
+  // last one is unbounded, so it's logged by its lower bound.
+  message = base::StringPrintf("PID=%d; Allocation sizes:",
+                               ::GetCurrentProcessId());
+  for (size_t i = 0; i < AsanRuntimeStatistics::kSizeClassCount; ++i) {
+    if (statistics.allocation_size_classes[i] == 0)
+      continue;
+    if (i + 1 < AsanRuntimeStatistics::kSizeClassCount) {
+      base::StringAppendF(&message, " <%llu=%u", 1ull << i,
+                          statistics.allocation_size_classes[i]);
+    } else {
+      base::StringAppendF(&message, " >=%llu=%u", 1ull << (i - 1),
+                          statistics.allocation_size_classes[i]);
+    }
+  }
+  logger_->Write(message);
+
+  for (size_t i = 0; i < statistics.heap_count; ++i) {
+    const AsanHeapLockStatistics& heap = statistics.heaps[i];
+    logger_->Write(base::StringPrintf(
+        "PID=%d; Heap type=%u; Lock acquisitions=%u; Contentions=%u; "
+        "Wait time=%llu us",
+        ::GetCurrentProcessId(),
+        heap.heap_type,
+        heap.acquisitions,
+        heap.contentions,
+        heap.wait_time_us));
+  }
+}
+
 AsanFeatureSet AsanRuntime::GetEnabledFeatureSet() {
   AsanFeatureSet enabled_features = static_cast<AsanFeatureSet>(0U);
   if (heap_manager_->enable_page_protections_)
@@ -28,7 +28,9 @@
 #include "syzygy/agent/asan/heap_checker.h"
 #include "syzygy/agent/asan/memory_notifier.h"
 #include "syzygy/agent/asan/reporter.h"
+#include "syzygy/agent/asan/runtime_statistics.h"
 #include "syzygy/agent/asan/heap_managers/block_heap_manager.h"
+#include "syzygy/agent/common/module_bounds_cache.h"
 #include "syzygy/agent/common/stack_capture.h"
 #include "syzygy/common/asan_parameters.h"
 
@@ -158,6 +160,9 @@ class AsanRuntime {
   // @param thread_id The thread ID that has been observed.
   void AddThreadId(uint32_t thread_id);
 
+  // Releases the per-thread resources of an exiting thread.
+  void OnThreadExit();
+
   // Determines if a thread ID has already been seen.
   // @param thread_id The thread ID to be queried.
   // @returns true if a given thread ID is valid for this process.
@@ -197,6 +202,11 @@ class AsanRuntime {
   // @returns the list of enabled features.
   AsanFeatureSet GetEnabledFeatureSet();
 
+  // Gets the statistics describing the activity of the runtime. These are
+  // also logged when the runtime is torn down.
+  // @param statistics Will receive the statistics.
+  void GetStatistics(AsanRuntimeStatistics* statistics);
+
   // Initialize the crash reporter used by the runtime.
   //
   // This function should only be called once during the runtime's lifetime,
@@ -267,7 +277,8 @@ class AsanRuntime {
   // Tear down the logger.
   void TearDownLogger();
 
-  // Set up the stack cache.
+  // Set up the stack cache, and the module cache used to compute the relative
+  // stack IDs.
   // @returns true on success, false otherwise.
   bool SetUpStackCache();
 
@@ -281,6 +292,9 @@ class AsanRuntime {
   // Tear down the heap manager.
   void TearDownHeapManager();
 
+  // Logs the statistics returned by GetStatistics.
+  void LogStatistics();
+
   // The unhandled exception filter registered by this runtime. This is used
   // to catch unhandled exceptions so we can augment them with information
   // about the corrupt heap.
@@ -318,6 +332,10 @@ class AsanRuntime {
   // The shared stack cache instance that will be used by all the heaps.
   std::unique_ptr<StackCaptureCache> stack_cache_;
 
+  // The cache of the module bounds used when computing the relative stack
+  // IDs. This is null on systems without DLL notifications.
+  std::unique_ptr<common::ModuleBoundsCache> module_bounds_cache_;
+
   // The asan error callback functor.
   AsanOnErrorCallBack asan_error_callback_;
 
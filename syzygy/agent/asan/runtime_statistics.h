@@ -0,0 +1,80 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the statistics exported by the Asan runtime. These describe the
+// activity of the heaps, the quarantines and the stack cache, and are meant to
+// be used to tune the runtime parameters for a given product. They are all
+// cheap to maintain and thus always collected.
+//
+// This structure is returned by asan_GetRuntimeStatistics, so it is a POD
+// with a fixed layout. New fields should be added strictly to the end.
+
+#ifndef SYZYGY_AGENT_ASAN_RUNTIME_STATISTICS_H_
+#define SYZYGY_AGENT_ASAN_RUNTIME_STATISTICS_H_
+
+#include <stdint.h>
+
+namespace agent {
+namespace asan {
+
+// The contention statistics of the lock protecting a single heap.
+struct AsanHeapLockStatistics {
+  // The type of the heap. This is a HeapType value.
+  uint32_t heap_type;
+  // The number of times the heap lock was acquired.
+  uint32_t acquisitions;
+  // The number of acquisitions that had to wait for another thread.
+  uint32_t contentions;
+  // The total time spent waiting for the heap lock, in microseconds.
+  uint64_t wait_time_us;
+};
+
+struct AsanRuntimeStatistics {
+  // The number of allocation size classes. Size class 0 counts the empty
+  // allocations, and size class i > 0 counts the allocations of
+  // [2^(i - 1), 2^i) bytes. The last class also counts anything bigger.
+  static const size_t kSizeClassCount = 32;
+  // The maximum number of heaps for which lock statistics are reported.
+  static const size_t kMaxHeapCount = 16;
+
+  // The size of this structure, in bytes. This is set by the runtime.
+  uint32_t size;
+
+  // The number of calls to Allocate and Free on the heap manager.
+  uint32_t allocations;
+  uint32_t frees;
+  // The histogram of the allocation sizes.
+  uint32_t allocation_size_classes[kSizeClassCount];
+
+  // The quarantine activity. A trim is a single pass of evictions, during which
+  // any number of blocks may be popped.
+  uint32_t quarantine_pushes;
+  uint32_t quarantine_pops;
+  uint32_t quarantine_trims;
+
+  // The number of stack traces saved to the stack cache, and how many of them
+  // were already present in it.
+  uint32_t stack_cache_requests;
+  uint32_t stack_cache_hits;
+
+  // The lock statistics of the heaps. Only the first |heap_count| entries are
+  // valid. Heaps that don't keep lock statistics aren't reported.
+  uint32_t heap_count;
+  AsanHeapLockStatistics heaps[kMaxHeapCount];
+};
+
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_RUNTIME_STATISTICS_H_
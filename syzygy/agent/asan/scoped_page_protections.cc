@@ -32,14 +32,16 @@ ScopedPageProtections::~ScopedPageProtections() {
 bool ScopedPageProtections::EnsureContainingPagesWritable(void* addr,
                                                           size_t size) {
   // Ensure the entire space of pages covered by the provided range is
-  // writable.
+  // writable. Runs of pages are unprotected at once where possible.
   uint8_t* cursor = reinterpret_cast<uint8_t*>(addr);
   uint8_t* page_begin = common::AlignDown(cursor, GetPageSize());
   uint8_t* page_end = common::AlignUp(cursor + size, GetPageSize());
   while (page_begin < page_end) {
-    if (!EnsurePageWritable(page_begin))
+    uint8_t* run_end = nullptr;
+    if (!EnsurePagesWritable(page_begin, page_end, &run_end))
       return false;
-    page_begin += GetPageSize();
+    DCHECK_LT(page_begin, run_end);
+    page_begin = run_end;
   }
 
   return true;
@@ -51,33 +53,51 @@ bool ScopedPageProtections::RestorePageProtections() {
   unprotected_pages_.swap(to_unprotect);
 
   // Best-effort restore the old page protections, and remember pages for
-  // which the effort failed.
+  // which the effort failed. Contiguous pages that shared the same original
+  // protection are restored by a single call.
   bool did_succeed = true;
-  for (const auto& unprotected_page : to_unprotect) {
+  auto run_begin = to_unprotect.begin();
+  while (run_begin != to_unprotect.end()) {
+    auto run_end = run_begin;
+    uint8_t* next_page = reinterpret_cast<uint8_t*>(run_begin->first);
+    while (run_end != to_unprotect.end() && run_end->first == next_page &&
+           run_end->second == run_begin->second) {
+      next_page += GetPageSize();
+      ++run_end;
+    }
+
+    size_t run_size = next_page - reinterpret_cast<uint8_t*>(run_begin->first);
     DWORD old_prot = 0;
-    if (!::VirtualProtect(unprotected_page.first, GetPageSize(),
-                          unprotected_page.second, &old_prot)) {
+    if (!::VirtualProtect(run_begin->first, run_size, run_begin->second,
+                          &old_prot)) {
       DWORD error = ::GetLastError();
       LOG(ERROR) << "VirtualProtect failed: " << common::LogWe(error);
 
       // Pages that failed to be unprotected are reinserted into the set of
       // pages being tracked.
-      bool inserted = unprotected_pages_.insert(unprotected_page).second;
-      DCHECK(inserted);
+      unprotected_pages_.insert(run_begin, run_end);
 
       did_succeed = false;
     }
+
+    run_begin = run_end;
   }
 
   return did_succeed;
 }
 
-bool ScopedPageProtections::EnsurePageWritable(void* page) {
+bool ScopedPageProtections::EnsurePagesWritable(uint8_t* page,
+                                                uint8_t* page_end,
+                                                uint8_t** run_end) {
   DCHECK(common::IsAligned(page, GetPageSize()));
+  DCHECK_LT(page, page_end);
+  DCHECK_NE(static_cast<uint8_t**>(nullptr), run_end);
 
   // Check whether we've already unprotected this page.
-  if (unprotected_pages_.find(page) != unprotected_pages_.end())
+  if (unprotected_pages_.find(page) != unprotected_pages_.end()) {
+    *run_end = page + GetPageSize();
     return true;
+  }
 
   // We didn't unprotect this yet, make the page writable.
   MEMORY_BASIC_INFORMATION memory_info{};
@@ -87,6 +107,16 @@ bool ScopedPageProtections::EnsurePageWritable(void* page) {
     return false;
   }
 
+  // Extend the run to the following pages that share the same protection and
+  // haven't been unprotected yet.
+  uint8_t* region_end = reinterpret_cast<uint8_t*>(memory_info.BaseAddress) +
+                        memory_info.RegionSize;
+  uint8_t* end = page + GetPageSize();
+  while (end < page_end && end < region_end &&
+         unprotected_pages_.find(end) == unprotected_pages_.end()) {
+    end += GetPageSize();
+  }
+
   // Preserve executable status while patching.
   DWORD is_executable = (PAGE_EXECUTE | PAGE_EXECUTE_READ |
                          PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY) &
@@ -96,21 +126,25 @@ bool ScopedPageProtections::EnsurePageWritable(void* page) {
     new_prot = PAGE_EXECUTE_READWRITE;
 
   DWORD old_prot = 0;
-  if (!::VirtualProtect(page, GetPageSize(), new_prot, &old_prot)) {
+  if (!::VirtualProtect(page, end - page, new_prot, &old_prot)) {
     DWORD error = ::GetLastError();
     LOG(ERROR) << "VirtualProtect failed: " << common::LogWe(error);
     return false;
   }
 
-  // Make a note that we modified this page, as well as its original settings.
-  bool inserted =
-      unprotected_pages_.insert(std::make_pair(page, old_prot)).second;
-  DCHECK(inserted);
+  // Make a note that we modified these pages, as well as their original
+  // settings. All of the pages in the run shared the same protection.
+  for (uint8_t* cursor = page; cursor < end; cursor += GetPageSize()) {
+    bool inserted =
+        unprotected_pages_.insert(std::make_pair(cursor, old_prot)).second;
+    DCHECK(inserted);
 
-  // Callback as a testing seam.
-  if (!on_unprotect_.is_null())
-    on_unprotect_.Run(page, old_prot);
+    // Callback as a testing seam.
+    if (!on_unprotect_.is_null())
+      on_unprotect_.Run(cursor, old_prot);
+  }
 
+  *run_end = end;
   return true;
 }
 
@@ -60,10 +60,16 @@ class ScopedPageProtections {
   }
 
  private:
-  // Helper function for EnsureContainingPagesWritable.
+  // Helper function for EnsureContainingPagesWritable. Makes writable the
+  // run of pages starting at @p page that share the same protection and that
+  // haven't already been made writable, using a single VirtualProtect call.
   // @pre page Points to the beginning of a page.
-  // @param page The address of the page to make writable.
-  bool EnsurePageWritable(void* page);
+  // @param page The address of the first page to make writable.
+  // @param page_end The end of the range of pages to consider.
+  // @param run_end Will receive the end of the run that was handled.
+  // @returns true on success, false otherwise.
+  bool EnsurePagesWritable(uint8_t* page, uint8_t* page_end,
+                           uint8_t** run_end);
 
   using UnprotectedPages = std::map<void*, DWORD>;
 
@@ -18,6 +18,9 @@
 #include "syzygy/agent/asan/scoped_page_protections.h"
 
 #include <cstdint>
+#include <vector>
+
+#include "base/bind.h"
 #include "base/logging.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/constants.h"
@@ -74,6 +77,13 @@ class ScopedPageProtectionsTest : public testing::Test {
   uint8_t* page_end_;
 };
 
+// Records the pages being unprotected, which are all expected to have been
+// read-only.
+void OnUnprotect(std::vector<void*>* pages, void* page, DWORD old_prot) {
+  EXPECT_EQ(PAGE_READONLY, old_prot);
+  pages->push_back(page);
+}
+
 }  // namespace
 
 TEST_F(ScopedPageProtectionsTest, ReadOnlyBecomesReadWrite) {
@@ -127,6 +137,28 @@ TEST_F(ScopedPageProtectionsTest, SpanMultiplePages) {
   EXPECT_EQ(PAGE_READONLY, GetProtection(2));
 }
 
+TEST_F(ScopedPageProtectionsTest, UnprotectsRunsOfPages) {
+  ScopedPageProtections spp;
+  std::vector<void*> pages;
+  spp.set_on_unprotect(base::Bind(&OnUnprotect, base::Unretained(&pages)));
+
+  // Unprotect the middle page first, then the whole range. Each page should
+  // be reported exactly once.
+  EXPECT_TRUE(spp.EnsureContainingPagesWritable(BaseOfPage(1), 1));
+  EXPECT_TRUE(spp.EnsureContainingPagesWritable(
+      BaseOfPage(0), kPageCount * GetPageSize()));
+  ASSERT_EQ(kPageCount, pages.size());
+  EXPECT_EQ(BaseOfPage(1), pages[0]);
+  EXPECT_EQ(BaseOfPage(0), pages[1]);
+  EXPECT_EQ(BaseOfPage(2), pages[2]);
+  for (size_t i = 0; i < kPageCount; ++i)
+    EXPECT_EQ(PAGE_READWRITE, GetProtection(i));
+
+  EXPECT_TRUE(spp.RestorePageProtections());
+  for (size_t i = 0; i < kPageCount; ++i)
+    EXPECT_EQ(PAGE_READONLY, GetProtection(i));
+}
+
 TEST_F(ScopedPageProtectionsTest, RestoresProtectionsInDestructor) {
   // The fixture should guarantee this.
   ASSERT_EQ(PAGE_READONLY, GetProtection(0));
@@ -19,7 +19,9 @@
 
 #include "base/strings/stringprintf.h"
 #include "base/win/pe_image.h"
+#include "syzygy/agent/asan/shadow_simd.h"
 #include "syzygy/common/align.h"
+#include "syzygy/common/large_pages.h"
 
 namespace agent {
 namespace asan {
@@ -35,9 +37,9 @@ base::Lock shadow_instance_lock;
 // TODO(loskutov): eliminate this by enforcing Shadow to be a singleton.
 const Shadow* shadow_instance = nullptr;
 
-// The exception handler, intended to map the pages for shadow and page_bits
-// on demand. When a page fault happens, the operating systems calls
-// this handler, and if the page is inside shadow or page_bits, it gets
+// The exception handler, intended to map the pages for shadow, page_bits and
+// the shadow summary on demand. When a page fault happens, the operating
+// systems calls this handler, and if the page is inside one of them, it gets
 // commited seamlessly for the caller, and then execution continues.
 // Otherwise, the OS keeps searching for an appropriate handler.
 LONG NTAPI ShadowExceptionHandler(PEXCEPTION_POINTERS exception_pointers) {
@@ -62,10 +64,16 @@ LONG NTAPI ShadowExceptionHandler(PEXCEPTION_POINTERS exception_pointers) {
   bool is_outside_of_page_bits = shadow_instance == nullptr ||
       addr < shadow_instance->page_bits() ||
       addr >= shadow_instance->page_bits() + shadow_instance->page_bits_size();
+  bool is_outside_of_summary = shadow_instance == nullptr ||
+      addr < shadow_instance->shadow_summary() ||
+      addr >= shadow_instance->shadow_summary() +
+          shadow_instance->shadow_summary_length();
 
   // Check valid shadow range.
-  if (is_outside_of_shadow && is_outside_of_page_bits)
+  if (is_outside_of_shadow && is_outside_of_page_bits &&
+      is_outside_of_summary) {
     return EXCEPTION_CONTINUE_SEARCH;
+  }
 
   // This is an access violation while trying to read from the shadow. Commit
   // the relevant page and let execution continue.
@@ -103,17 +111,35 @@ extern "C" {
 uint8_t asan_memory_interceptors_shadow_memory[1] = {};
 }
 
-Shadow::Shadow() : own_memory_(false), shadow_(nullptr), length_(0) {
-  Init(RequiredLength());
+Shadow::Shadow()
+    : own_memory_(false), large_pages_(false), shadow_(nullptr), length_(0),
+      shadow_summary_(nullptr),
+      shadow_summary_length_(0),
+      decommit_released_memory_(false) {
+  Init(RequiredLength(), false);
 }
 
 Shadow::Shadow(size_t length)
-    : own_memory_(false), shadow_(nullptr), length_(0) {
-  Init(length);
+    : own_memory_(false), large_pages_(false), shadow_(nullptr), length_(0),
+      shadow_summary_(nullptr),
+      shadow_summary_length_(0),
+      decommit_released_memory_(false) {
+  Init(length, false);
+}
+
+Shadow::Shadow(size_t length, bool use_large_pages)
+    : own_memory_(false), large_pages_(false), shadow_(nullptr), length_(0),
+      shadow_summary_(nullptr),
+      shadow_summary_length_(0),
+      decommit_released_memory_(false) {
+  Init(length, use_large_pages);
 }
 
 Shadow::Shadow(void* shadow, size_t length)
-    : own_memory_(false), shadow_(nullptr), length_(0) {
+    : own_memory_(false), large_pages_(false), shadow_(nullptr), length_(0),
+      shadow_summary_(nullptr),
+      shadow_summary_length_(0),
+      decommit_released_memory_(false) {
   Init(false, shadow, length);
 }
 
@@ -129,7 +155,10 @@ Shadow::~Shadow() {
   if (own_memory_)
     CHECK(::VirtualFree(shadow_, 0, MEM_RELEASE));
   CHECK(::VirtualFree(page_bits_, 0, MEM_RELEASE));
+  if (shadow_summary_ != nullptr)
+    CHECK(::VirtualFree(shadow_summary_, 0, MEM_RELEASE));
   own_memory_ = false;
+  large_pages_ = false;
   shadow_ = nullptr;
   length_ = 0;
 }
@@ -165,6 +194,8 @@ void Shadow::SetUp() {
   Poison(shadow_, length_, kAsanMemoryMarker);
   // Poison the protection bits array.
   Poison(page_bits_, page_bits_length_, kAsanMemoryMarker);
+  // Poison the shadow summary.
+  Poison(shadow_summary_, shadow_summary_length_, kAsanMemoryMarker);
 #endif
 }
 
@@ -184,6 +215,8 @@ void Shadow::TearDown() {
   Unpoison(shadow_, length_);
   // Unpoison the protection bits array.
   Unpoison(page_bits_, page_bits_length_);
+  // Unpoison the shadow summary.
+  Unpoison(shadow_summary_, shadow_summary_length_);
 #endif
 }
 
@@ -201,6 +234,12 @@ bool Shadow::IsClean() const {
       reinterpret_cast<uintptr_t>(page_bits_ + page_bits_length_) >>
           kShadowRatioLog;
 
+  const size_t summary_begin =
+      reinterpret_cast<uintptr_t>(shadow_summary_) >> kShadowRatioLog;
+  const size_t summary_end =
+      reinterpret_cast<uintptr_t>(shadow_summary_ + shadow_summary_length_) >>
+          kShadowRatioLog;
+
   void const* self = nullptr;
   size_t self_size = 0;
   GetPointerAndSize(&self, &self_size);
@@ -234,6 +273,7 @@ bool Shadow::IsClean() const {
     for (; i < next_i; ++i) {
       if ((i >= shadow_begin && i < shadow_end) ||
           (i >= page_bits_begin && i < page_bits_end) ||
+          (i >= summary_begin && i < summary_end) ||
           (i >= this_begin && i < this_end)) {
         if (shadow_[i] != kAsanMemoryMarker)
           return false;
@@ -274,14 +314,33 @@ void Shadow::GetPointerAndSizeImpl(void const** self, size_t* size) const {
   *size = sizeof(*this);
 }
 
-void Shadow::Init(size_t length) {
+void Shadow::Init(size_t length, bool use_large_pages) {
   DCHECK_LT(0u, length);
 
+  void* mem = nullptr;
 #ifndef _WIN64
+  // Large pages must be committed all at once, which is only done on 32-bit.
+  if (use_large_pages) {
+    size_t large_page_size = ::common::EnableLargePages();
+    if (large_page_size != 0) {
+      mem = ::VirtualAlloc(nullptr,
+                           ::common::AlignUp(length, large_page_size),
+                           MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                           PAGE_READWRITE);
+    }
+    if (mem == nullptr)
+      LOG(WARNING) << "Unable to back the shadow with large pages.";
+  }
+
   // The allocation may fail and it needs to be handled gracefully.
-  void* mem = ::VirtualAlloc(nullptr, length, MEM_COMMIT, PAGE_READWRITE);
+  if (mem == nullptr)
+    mem = ::VirtualAlloc(nullptr, length, MEM_COMMIT, PAGE_READWRITE);
+  else
+    large_pages_ = true;
 #else
-  void* mem = ::VirtualAlloc(nullptr, length, MEM_RESERVE, PAGE_NOACCESS);
+  if (use_large_pages)
+    LOG(WARNING) << "Large pages aren't supported for a sparse shadow.";
+  mem = ::VirtualAlloc(nullptr, length, MEM_RESERVE, PAGE_NOACCESS);
 #endif
   Init(true, mem, length);
 }
@@ -325,15 +384,30 @@ void Shadow::Init(bool own_memory, void* shadow, size_t length) {
                                                     MEM_RESERVE,
                                                     PAGE_NOACCESS));
 #endif
+
+  // Initialize the shadow summary. As with the shadow, freshly allocated
+  // memory describes a fully accessible address space.
+  shadow_summary_length_ = ::common::AlignUp(
+      (length + kShadowSummaryRatio - 1) / kShadowSummaryRatio, kShadowRatio);
+#ifndef _WIN64
+  shadow_summary_ = static_cast<uint8_t*>(::VirtualAlloc(
+      nullptr, shadow_summary_length_, MEM_COMMIT, PAGE_READWRITE));
+#else
+  shadow_summary_ = static_cast<uint8_t*>(::VirtualAlloc(
+      nullptr, shadow_summary_length_, MEM_RESERVE, PAGE_NOACCESS));
+#endif
+  CHECK_NE(static_cast<uint8_t*>(nullptr), shadow_summary_);
 }
 
 void Shadow::Reset() {
 #ifndef _WIN64
   ::memset(shadow_, 0, length_);
   ::memset(page_bits_, 0, page_bits_length_);
+  ::memset(shadow_summary_, kShadowSummaryAccessible, shadow_summary_length_);
 #else
   ::VirtualFree(shadow_, length_, MEM_DECOMMIT);
   ::VirtualFree(page_bits_, page_bits_length_, MEM_DECOMMIT);
+  ::VirtualFree(shadow_summary_, shadow_summary_length_, MEM_DECOMMIT);
 #endif
 
   SetShadowMemory(0, kShadowRatio * length_, kHeapAddressableMarker);
@@ -347,12 +421,17 @@ void Shadow::Poison(const void* addr, size_t size, ShadowMarker shadow_val) {
   SetShadowMemory(addr, size, shadow_val);
 
   index >>= kShadowRatioLog;
-  if (start)
+  if (start) {
+    BeginShadowSummaryUpdate(index, 1, kShadowSummaryMixed);
     shadow_[index++] = start;
+  }
 
   size >>= kShadowRatioLog;
   DCHECK_GT(length_, index + size);
+  ShadowSummaryState state = GetShadowSummaryStateForMarker(shadow_val);
+  BeginShadowSummaryUpdate(index, size, state);
   ::memset(shadow_ + index, shadow_val, size);
+  EndShadowSummaryUpdate(index, size, state);
 }
 
 void Shadow::Unpoison(const void* addr, size_t size) {
@@ -365,10 +444,33 @@ void Shadow::Unpoison(const void* addr, size_t size) {
   index >>= kShadowRatioLog;
   size >>= kShadowRatioLog;
   DCHECK_GT(length_, index + size);
+  BeginShadowSummaryUpdate(index, size, kShadowSummaryAccessible);
   ::memset(shadow_ + index, kHeapAddressableMarker, size);
+  EndShadowSummaryUpdate(index, size, kShadowSummaryAccessible);
 
-  if (remainder != 0)
+  if (remainder != 0) {
+    BeginShadowSummaryUpdate(index + size, 1, kShadowSummaryMixed);
     shadow_[index + size] = remainder;
+  }
+}
+
+void Shadow::ReleaseMemory(const void* addr, size_t size) {
+  Unpoison(addr, size);
+
+#ifdef _WIN64
+  if (!decommit_released_memory_)
+    return;
+
+  // Only the pages of shadow fully covered by the released range can be
+  // decommitted. A decommitted page is zero filled once committed again, and
+  // will thus be read as accessible memory.
+  size_t index = reinterpret_cast<uintptr_t>(addr) >> kShadowRatioLog;
+  uint8_t* begin = ::common::AlignUp(shadow_ + index, kPageSize);
+  size_t end_index = index + (size >> kShadowRatioLog);
+  uint8_t* end = ::common::AlignDown(shadow_ + end_index, kPageSize);
+  if (begin < end)
+    CHECK(::VirtualFree(begin, end - begin, MEM_DECOMMIT));
+#endif
 }
 
 namespace {
@@ -381,54 +483,6 @@ static const uint32_t kFreedMarker32 =
 static const uint64_t kFreedMarker64 =
     (static_cast<const uint64_t>(kFreedMarker32) << 32) | kFreedMarker32;
 
-// Marks the given range of shadow bytes as freed, preserving left and right
-// redzone bytes.
-inline void MarkAsFreedImpl8(uint8_t* cursor, uint8_t* cursor_end) {
-  for (; cursor != cursor_end; ++cursor) {
-    // Preserve block beginnings/ends/redzones as they were originally.
-    // This is necessary to preserve information about nested blocks.
-    if (ShadowMarkerHelper::IsActiveLeftRedzone(*cursor) ||
-        ShadowMarkerHelper::IsActiveRightRedzone(*cursor)) {
-      continue;
-    }
-
-    // Anything else gets marked as freed.
-    *cursor = kHeapFreedMarker;
-  }
-}
-
-// Marks the given range of shadow bytes as freed, preserving left and right
-// redzone bytes. |cursor| and |cursor_end| must be 8-byte aligned.
-inline void MarkAsFreedImplAligned64(uint64_t* cursor, uint64_t* cursor_end) {
-  DCHECK(::common::IsAligned(cursor, sizeof(uint64_t)));
-  DCHECK(::common::IsAligned(cursor_end, sizeof(uint64_t)));
-
-  for (; cursor != cursor_end; ++cursor) {
-    // If the block of shadow memory is entirely green then mark as freed.
-    // Otherwise go check its contents byte by byte.
-    if (*cursor == 0) {
-      *cursor = kFreedMarker64;
-    } else {
-      MarkAsFreedImpl8(reinterpret_cast<uint8_t*>(cursor),
-                       reinterpret_cast<uint8_t*>(cursor + 1));
-    }
-  }
-}
-
-inline void MarkAsFreedImpl64(uint8_t* cursor, uint8_t* cursor_end) {
-  if (cursor_end - cursor >= 2 * sizeof(uint64_t)) {
-    uint8_t* cursor_aligned = ::common::AlignUp(cursor, sizeof(uint64_t));
-    uint8_t* cursor_end_aligned =
-        ::common::AlignDown(cursor_end, sizeof(uint64_t));
-    MarkAsFreedImpl8(cursor, cursor_aligned);
-    MarkAsFreedImplAligned64(reinterpret_cast<uint64_t*>(cursor_aligned),
-                             reinterpret_cast<uint64_t*>(cursor_end_aligned));
-    MarkAsFreedImpl8(cursor_end_aligned, cursor_end);
-  } else {
-    MarkAsFreedImpl8(cursor, cursor_end);
-  }
-}
-
 }  // namespace
 
 void Shadow::MarkAsFreed(const void* addr, size_t size) {
@@ -446,8 +500,10 @@ void Shadow::MarkAsFreed(const void* addr, size_t size) {
   uint8_t* cursor_end = static_cast<uint8_t*>(cursor) + length;
 
   // This isn't as simple as a memset because we need to preserve left and
-  // right redzone padding bytes that may be found in the range.
-  MarkAsFreedImpl64(cursor, cursor_end);
+  // right redzone padding bytes that may be found in the range. This also
+  // means that the result can't be summarized.
+  BeginShadowSummaryUpdate(index, length, kShadowSummaryMixed);
+  internal::MarkAsFreed(cursor, cursor_end);
 }
 
 bool Shadow::IsAccessible(const void* addr) const {
@@ -504,8 +560,12 @@ bool Shadow::IsRangeAccessible(const void* addr, size_t size) const {
 
   // Now run over the shadow bytes from start to end, which all need to be
   // zero.
-  if (!internal::IsZeroBufferImpl<uint64_t>(&shadow_[start], &shadow_[end]))
+  if (end - start < kShadowSummaryRatio) {
+    if (!internal::IsZeroBuffer(&shadow_[start], &shadow_[end]))
       return false;
+  } else if (FindFirstNonZeroShadowByte(start, end) != &shadow_[end]) {
+    return false;
+  }
 
   // Finally test the end point if there's a tail offset.
   if (end_offs == 0U)
@@ -560,12 +620,22 @@ const void* Shadow::FindFirstPoisonedByte(const void* addr, size_t size) const {
   if (end > length_)
     return out_addr;
 
-  for (size_t curr = start; curr < end; ++curr, out_addr += kShadowRatio) {
-    shadow = shadow_[curr];
-    if (ShadowMarkerHelper::IsRedzone(shadow))
-      return out_addr;
-    if (shadow != 0)
+  // Skip over the accessible part of the range. Only the first non-zero
+  // shadow byte needs to be looked at.
+  if (start < end) {
+    const uint8_t* found = nullptr;
+    if (end - start < kShadowSummaryRatio) {
+      found = internal::FindFirstNonZeroByte(&shadow_[start], &shadow_[end]);
+    } else {
+      found = FindFirstNonZeroShadowByte(start, end);
+    }
+    out_addr += (found - &shadow_[start]) * kShadowRatio;
+    if (found != &shadow_[end]) {
+      shadow = *found;
+      if (ShadowMarkerHelper::IsRedzone(shadow))
+        return out_addr;
       return out_addr + shadow;
+    }
   }
 
   // Finally test the end point if there's a tail offset.
@@ -672,6 +742,12 @@ void Shadow::PoisonAllocatedBlock(const BlockInfo& info) {
   // Determine the marker byte for the trailer.
   ShadowMarker trailer_marker = ShadowMarkerHelper::BuildBlockEnd(true);
 
+  // The body of large blocks may cover entire ranges of the shadow summary,
+  // which are then known to be accessible.
+  size_t summary_body_index = index + left_redzone_bytes;
+  size_t summary_body_length = info.body_size / kShadowRatio;
+  BeginShadowSummaryUpdate(index, block_bytes, kShadowSummaryMixed);
+
   // Poison the header and left padding.
   uint8_t* cursor = shadow_ + index;
   ::memset(cursor, header_marker, 1);
@@ -685,6 +761,8 @@ void Shadow::PoisonAllocatedBlock(const BlockInfo& info) {
     cursor[-1] = body_size_mod;
   ::memset(cursor, kHeapRightPaddingMarker, right_redzone_bytes - 1);
   ::memset(cursor + right_redzone_bytes - 1, trailer_marker, 1);
+  EndShadowSummaryUpdate(summary_body_index, summary_body_length,
+                         kShadowSummaryAccessible);
 
   SetShadowMemory(info.header,
                   info.TotalHeaderSize(),
@@ -785,6 +863,79 @@ void Shadow::MarkPagesUnprotected(const void* addr, size_t size) {
   }
 }
 
+// static
+Shadow::ShadowSummaryState Shadow::GetShadowSummaryStateForMarker(
+    uint8_t marker) {
+  if (marker == kHeapAddressableMarker)
+    return kShadowSummaryAccessible;
+  if (ShadowMarkerHelper::IsRedzone(marker) &&
+      !ShadowMarkerHelper::IsBlockStart(marker) &&
+      !ShadowMarkerHelper::IsBlockEnd(marker)) {
+    return kShadowSummaryPoisoned;
+  }
+  return kShadowSummaryMixed;
+}
+
+void Shadow::BeginShadowSummaryUpdate(size_t index,
+                                      size_t length,
+                                      ShadowSummaryState state) {
+  if (length == 0)
+    return;
+  DCHECK_GE(length_, index + length);
+
+  // A summary that already matches the values being written remains valid,
+  // even for partially covered ranges. Every other summary is invalidated
+  // before the shadow changes, so that readers never see a summary claiming
+  // more than what the shadow holds.
+  size_t summary_end = (index + length - 1) / kShadowSummaryRatio + 1;
+  for (size_t i = index / kShadowSummaryRatio; i < summary_end; ++i) {
+    if (shadow_summary_[i] != state)
+      shadow_summary_[i] = kShadowSummaryMixed;
+  }
+}
+
+void Shadow::EndShadowSummaryUpdate(size_t index,
+                                    size_t length,
+                                    ShadowSummaryState state) {
+  if (state == kShadowSummaryMixed)
+    return;
+  DCHECK_GE(length_, index + length);
+
+  // Only the fully covered ranges are known to be uniform.
+  size_t summary_begin =
+      (index + kShadowSummaryRatio - 1) / kShadowSummaryRatio;
+  size_t summary_end = (index + length) / kShadowSummaryRatio;
+  for (size_t i = summary_begin; i < summary_end; ++i)
+    shadow_summary_[i] = state;
+}
+
+const uint8_t* Shadow::FindFirstNonZeroShadowByte(size_t index,
+                                                  size_t end) const {
+  DCHECK_LE(index, end);
+  DCHECK_GE(length_, end);
+
+  while (index < end) {
+    size_t range_end = std::min(
+        end, (index / kShadowSummaryRatio + 1) * kShadowSummaryRatio);
+    switch (GetShadowSummaryState(index)) {
+      case kShadowSummaryAccessible:
+        break;
+      case kShadowSummaryPoisoned:
+        return shadow_ + index;
+      default: {
+        const uint8_t* found = internal::FindFirstNonZeroByte(
+            shadow_ + index, shadow_ + range_end);
+        if (found != shadow_ + range_end)
+          return found;
+        break;
+      }
+    }
+    index = range_end;
+  }
+
+  return shadow_ + end;
+}
+
 void Shadow::AppendShadowByteText(const char *prefix,
                                   uintptr_t index,
                                   std::string* output,
@@ -1133,6 +1284,18 @@ bool ShadowWalker::Next(BlockInfo* info) {
 
     // Scan this committed portion of the shadow.
     while (shadow_cursor_ < end_of_region) {
+      // Skip over the ranges of shadow that are summarized as not containing
+      // any block markers. The summary is only consulted when entering a new
+      // range.
+      size_t cursor_index = shadow_cursor_ - shadow_->shadow();
+      if (cursor_index % Shadow::kShadowSummaryRatio == 0 &&
+          shadow_->GetShadowSummaryState(cursor_index) !=
+              Shadow::kShadowSummaryMixed) {
+        shadow_cursor_ = std::min(
+            end_of_region, shadow_cursor_ + Shadow::kShadowSummaryRatio);
+        continue;
+      }
+
       uint8_t marker = *shadow_cursor_;
 
       // Update the nesting depth when block end markers are encountered.
@@ -89,6 +89,23 @@ class Shadow {
   // shadow bytes will be reported in all.
   static const size_t kShadowContextLines = 4;
 
+  // The number of shadow bytes described by each byte of the shadow summary.
+  // A summary byte thus covers kShadowSummaryRatio * kShadowRatio bytes of
+  // memory.
+  static const size_t kShadowSummaryRatio = 4096;
+
+  // The states in which the shadow summary can describe a range of
+  // kShadowSummaryRatio shadow bytes.
+  enum ShadowSummaryState {
+    // All of the shadow bytes are kHeapAddressableMarker.
+    kShadowSummaryAccessible = 0,
+    // All of the shadow bytes are redzone markers, none of which is a block
+    // start or a block end marker.
+    kShadowSummaryPoisoned = 1,
+    // Nothing is known about the shadow bytes.
+    kShadowSummaryMixed = 2,
+  };
+
   // Default constructor. Creates a shadow memory of the appropriate size
   // depending on the addressable memory for this process.
   // @note The allocation may fail, in which case 'shadow()' will return
@@ -102,6 +119,18 @@ class Shadow {
   //     nullptr. If this is true the object should not be used.
   explicit Shadow(size_t length);
 
+  // Shadow constructor. Allocates shadow memory internally, optionally backed
+  // by large pages.
+  // @param length The length of the shadow memory in bytes. This implicitly
+  //     encodes the maximum addressable address of the shadow.
+  // @param use_large_pages If true, tries to back the shadow with large pages
+  //     to cut down on TLB misses. Falls back to regular pages if they can't
+  //     be used, which is always the case on 64-bit where the shadow is a
+  //     sparse reservation committed on demand.
+  // @note The allocation may fail, in which case 'shadow()' will return
+  //     nullptr. If this is true the object should not be used.
+  Shadow(size_t length, bool use_large_pages);
+
   // Shadow constructor.
   // @param shadow The array to use for storing the shadow memory. The shadow
   //     memory allocation *must* be kShadowRatio byte aligned.
@@ -134,6 +163,16 @@ class Shadow {
   // @param size The size of the memory to unpoison.
   void Unpoison(const void* addr, size_t size);
 
+  // Un-poisons @p size bytes starting at @p addr, which are being returned to
+  // the OS. When decommitting is enabled this also decommits the pages of
+  // shadow memory that only describe this range. These are committed again
+  // on demand by the exception handler, and then read as accessible memory.
+  // This is only supported on x64, where the shadow is a sparse array.
+  // @pre addr mod 8 == 0 && size mod 8 == 0.
+  // @param addr The starting address.
+  // @param size The size of the memory being released.
+  void ReleaseMemory(const void* addr, size_t size);
+
   // Mark @p size bytes starting at @p addr as freed.
   // @param addr The starting address.
   // @param size The size of the memory to mark as freed.
@@ -291,6 +330,38 @@ class Shadow {
   // Returns the length of the page bits array.
   size_t const page_bits_size() const { return page_bits_length_; }
 
+  // Read only accessor of the shadow summary.
+  const uint8_t* shadow_summary() const { return shadow_summary_; }
+
+  // Returns the length of the shadow summary array.
+  size_t shadow_summary_length() const { return shadow_summary_length_; }
+
+  // Returns the summary of the range of shadow memory containing a given
+  // shadow byte. As the shadow itself this is read without a lock, so a
+  // summary can only be relied upon for ranges that aren't being concurrently
+  // modified.
+  // @param index The index of the shadow byte.
+  // @returns the summary state of the kShadowSummaryRatio aligned range of
+  //     shadow bytes containing @p index.
+  ShadowSummaryState GetShadowSummaryState(size_t index) const {
+    DCHECK_GT(length_, index);
+    return static_cast<ShadowSummaryState>(
+        shadow_summary_[index / kShadowSummaryRatio]);
+  }
+
+  // @name Accessors for the decommitting of the shadow memory describing
+  //     released memory. This is disabled by default, and has no effect on
+  //     32-bit where the shadow is always fully committed.
+  // @{
+  bool decommit_released_memory() const { return decommit_released_memory_; }
+  void set_decommit_released_memory(bool decommit_released_memory) {
+    decommit_released_memory_ = decommit_released_memory;
+  }
+  // @}
+
+  // @returns true if the shadow memory is backed by large pages.
+  bool large_pages() const { return large_pages_; }
+
   // Determines if the shadow memory is clean. That is, it reflects the
   // state of shadow memory immediately after construction and a call to
   // SetUp.
@@ -313,7 +384,7 @@ class Shadow {
   virtual void GetPointerAndSizeImpl(void const** self, size_t* size) const;
 
   // Initializes this shadow object.
-  void Init(size_t length);
+  void Init(size_t length, bool use_large_pages);
   void Init(bool own_memory, void* shadow, size_t length);
 
   // Reset the shadow memory.
@@ -350,9 +421,41 @@ class Shadow {
       const void* addr,
       CompactBlockInfo* info) const;
 
+  // @param marker A shadow marker.
+  // @returns the summary state of a range of shadow memory filled with
+  //     @p marker.
+  static ShadowSummaryState GetShadowSummaryStateForMarker(uint8_t marker);
+
+  // Updates the shadow summary around a modification of the shadow bytes
+  // [@p index, @p index + @p length). BeginShadowSummaryUpdate must be called
+  // before the shadow bytes are written, and marks the summary as mixed
+  // wherever it may no longer hold. EndShadowSummaryUpdate must be called
+  // afterwards, and sets the summary of the fully covered ranges.
+  // @param index The index of the first shadow byte being modified.
+  // @param length The number of shadow bytes being modified.
+  // @param state The summary state of the values being written. This is
+  //     kShadowSummaryMixed if they aren't all of the same kind.
+  void BeginShadowSummaryUpdate(size_t index,
+                                size_t length,
+                                ShadowSummaryState state);
+  void EndShadowSummaryUpdate(size_t index,
+                              size_t length,
+                              ShadowSummaryState state);
+
+  // Finds the first non-zero shadow byte in a range, skipping over the parts
+  // of the range that are summarized as accessible.
+  // @param index The index of the first shadow byte to test.
+  // @param end The index of the byte after the last shadow byte to test.
+  // @returns a pointer to the first non-zero shadow byte in the range, or
+  //     shadow_ + @p end if there is none.
+  const uint8_t* FindFirstNonZeroShadowByte(size_t index, size_t end) const;
+
   // If this is true then this shadow object owns the memory.
   bool own_memory_;
 
+  // If this is true then the shadow memory is backed by large pages.
+  bool large_pages_;
+
   // The actual shadow that is being referred to. In case of large
   // address spaces it's stored as a sparse array
   // (see ShadowExceptionHandler in the .cc file).
@@ -373,6 +476,19 @@ class Shadow {
   // The length of page_bits_. Under page_bits_lock_.
   size_t page_bits_length_;
 
+  // One ShadowSummaryState per kShadowSummaryRatio bytes of the shadow. This
+  // allows whole pages of uniform shadow to be skipped when checking ranges
+  // and walking blocks. It is kept up to date by every function writing to the
+  // shadow, and is stored as a sparse array in the same manner as the shadow
+  // with large address spaces.
+  uint8_t* shadow_summary_;
+
+  // The length of shadow_summary_.
+  size_t shadow_summary_length_;
+
+  // Indicates if ReleaseMemory decommits the shadow memory that it can.
+  bool decommit_released_memory_;
+
 #ifdef _WIN64
   // The exception handler handle to be able to remove it on object destruction.
   HANDLE exception_handler_;
@@ -36,7 +36,26 @@ bool Shadow::GetNullTerminatedArraySize(const void* addr,
   // Scan the input array 8 bytes at a time until we've found a NULL value or
   // we've reached the end of an accessible memory block.
   // TODO(sebmarchand): Look into doing this more efficiently.
+  size_t summary_index = index;
   while (true) {
+    // Memory whose shadow is summarized as accessible can be scanned without
+    // looking at the individual shadow bytes. The summary is only consulted
+    // when entering a new range of shadow.
+    if (index == summary_index && index < length_) {
+      summary_index = index - index % kShadowSummaryRatio + kShadowSummaryRatio;
+      if (GetShadowSummaryState(index) == kShadowSummaryAccessible) {
+        size_t count = (summary_index - index) * (kShadowRatio / sizeof(type));
+        while (count-- > 0) {
+          (*size) += sizeof(type);
+          if (*size == max_size || *addr_value == 0)
+            return true;
+          addr_value++;
+        }
+        index = summary_index;
+        continue;
+      }
+    }
+
     uint8_t shadow = shadow_[index++];
     if (ShadowMarkerHelper::IsRedzone(shadow))
       return false;
@@ -0,0 +1,386 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_simd.h"
+
+#include <windows.h>
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "base/logging.h"
+#include "syzygy/agent/asan/shadow.h"
+#include "syzygy/agent/asan/shadow_marker.h"
+#include "syzygy/common/align.h"
+
+namespace agent {
+namespace asan {
+namespace internal {
+
+namespace {
+
+// CPUID feature bits.
+const int kCpuidLeaf1EdxSse2 = 1 << 26;
+const int kCpuidLeaf1EcxOsxsave = 1 << 27;
+const int kCpuidLeaf1EcxAvx = 1 << 28;
+const int kCpuidLeaf7EbxAvx2 = 1 << 5;
+
+// The XCR0 bits indicating that the OS preserves the XMM and YMM registers.
+const uint64_t kXcr0XmmYmmState = 0x6;
+
+// Ranges shorter than this are handled by the scalar kernels, as the setup
+// cost of the vector ones isn't worth it.
+const size_t kMinVectorRangeSize = 64;
+
+// The cached result of GetShadowSimdLevel, or -1 if not yet computed. This is
+// constant initialized so that it's usable before the CRT is.
+volatile LONG shadow_simd_level = -1;
+
+// A word of freed markers.
+const uint64_t kFreedMarker64 = 0x0101010101010101ULL * kHeapFreedMarker;
+
+ShadowSimdLevel DetectShadowSimdLevel() {
+  int regs[4] = {};  // EAX, EBX, ECX and EDX.
+  ::__cpuid(regs, 0);
+  int max_leaf = regs[0];
+  if (max_leaf < 1)
+    return kShadowSimdNone;
+
+  ::__cpuid(regs, 1);
+  if ((regs[3] & kCpuidLeaf1EdxSse2) == 0)
+    return kShadowSimdNone;
+
+  // AVX2 additionally requires the OS to save the YMM registers.
+  if (max_leaf < 7 || (regs[2] & kCpuidLeaf1EcxOsxsave) == 0 ||
+      (regs[2] & kCpuidLeaf1EcxAvx) == 0) {
+    return kShadowSimdSse2;
+  }
+  if ((::_xgetbv(0) & kXcr0XmmYmmState) != kXcr0XmmYmmState)
+    return kShadowSimdSse2;
+
+  ::__cpuidex(regs, 7, 0);
+  if ((regs[1] & kCpuidLeaf7EbxAvx2) == 0)
+    return kShadowSimdSse2;
+
+  return kShadowSimdAvx2;
+}
+
+// @name Scalar kernels.
+// @{
+
+const uint8_t* FindFirstNonZeroByte8(const uint8_t* cursor,
+                                     const uint8_t* cursor_end) {
+  for (; cursor != cursor_end; ++cursor) {
+    if (*cursor != 0)
+      return cursor;
+  }
+  return cursor_end;
+}
+
+const uint8_t* FindFirstNonZeroByte64(const uint8_t* cursor,
+                                      const uint8_t* cursor_end) {
+  const uint8_t* cursor_aligned = ::common::AlignUp(cursor, sizeof(uint64_t));
+  const uint8_t* cursor_end_aligned =
+      ::common::AlignDown(cursor_end, sizeof(uint64_t));
+  if (cursor_aligned >= cursor_end_aligned)
+    return FindFirstNonZeroByte8(cursor, cursor_end);
+
+  const uint8_t* found = FindFirstNonZeroByte8(cursor, cursor_aligned);
+  if (found != cursor_aligned)
+    return found;
+  for (cursor = cursor_aligned; cursor != cursor_end_aligned;
+       cursor += sizeof(uint64_t)) {
+    if (*reinterpret_cast<const uint64_t*>(cursor) != 0)
+      return FindFirstNonZeroByte8(cursor, cursor + sizeof(uint64_t));
+  }
+  return FindFirstNonZeroByte8(cursor_end_aligned, cursor_end);
+}
+
+// Marks the given range of shadow bytes as freed, preserving left and right
+// redzone bytes.
+void MarkAsFreed8(uint8_t* cursor, uint8_t* cursor_end) {
+  for (; cursor != cursor_end; ++cursor) {
+    // Preserve block beginnings/ends/redzones as they were originally.
+    // This is necessary to preserve information about nested blocks.
+    if (ShadowMarkerHelper::IsActiveLeftRedzone(*cursor) ||
+        ShadowMarkerHelper::IsActiveRightRedzone(*cursor)) {
+      continue;
+    }
+
+    // Anything else gets marked as freed.
+    *cursor = kHeapFreedMarker;
+  }
+}
+
+void MarkAsFreed64(uint8_t* cursor, uint8_t* cursor_end) {
+  uint8_t* cursor_aligned = ::common::AlignUp(cursor, sizeof(uint64_t));
+  uint8_t* cursor_end_aligned =
+      ::common::AlignDown(cursor_end, sizeof(uint64_t));
+  if (cursor_aligned >= cursor_end_aligned) {
+    MarkAsFreed8(cursor, cursor_end);
+    return;
+  }
+
+  MarkAsFreed8(cursor, cursor_aligned);
+  for (uint64_t* cursor64 = reinterpret_cast<uint64_t*>(cursor_aligned);
+       cursor64 != reinterpret_cast<uint64_t*>(cursor_end_aligned);
+       ++cursor64) {
+    // If the block of shadow memory is entirely green then mark as freed.
+    // Otherwise go check its contents byte by byte.
+    if (*cursor64 == 0) {
+      *cursor64 = kFreedMarker64;
+    } else {
+      MarkAsFreed8(reinterpret_cast<uint8_t*>(cursor64),
+                   reinterpret_cast<uint8_t*>(cursor64 + 1));
+    }
+  }
+  MarkAsFreed8(cursor_end_aligned, cursor_end);
+}
+
+// @}
+
+// @name SSE2 kernels. These handle the unaligned head and tail of the range
+//     with the scalar kernels, and the rest with aligned 16-byte accesses.
+//     Ranges that don't contain an aligned chunk are handled entirely by the
+//     scalar kernels.
+// @{
+
+bool IsZeroBufferSse2(const uint8_t* start, const uint8_t* end) {
+  const uint8_t* start_aligned = ::common::AlignUp(start, sizeof(__m128i));
+  const uint8_t* end_aligned = ::common::AlignDown(end, sizeof(__m128i));
+  if (start_aligned > end_aligned)
+    return IsZeroBufferImpl<uint64_t>(start, end);
+  if (!IsZeroBufferImpl<uint64_t>(start, start_aligned))
+    return false;
+
+  const __m128i zero = _mm_setzero_si128();
+  for (const __m128i* cursor = reinterpret_cast<const __m128i*>(start_aligned);
+       cursor != reinterpret_cast<const __m128i*>(end_aligned); ++cursor) {
+    __m128i cmp = _mm_cmpeq_epi8(_mm_load_si128(cursor), zero);
+    if (_mm_movemask_epi8(cmp) != 0xFFFF)
+      return false;
+  }
+
+  return IsZeroBufferImpl<uint64_t>(end_aligned, end);
+}
+
+const uint8_t* FindFirstNonZeroByteSse2(const uint8_t* start,
+                                        const uint8_t* end) {
+  const uint8_t* start_aligned = ::common::AlignUp(start, sizeof(__m128i));
+  const uint8_t* end_aligned = ::common::AlignDown(end, sizeof(__m128i));
+  if (start_aligned > end_aligned)
+    return FindFirstNonZeroByte64(start, end);
+  const uint8_t* found = FindFirstNonZeroByte64(start, start_aligned);
+  if (found != start_aligned)
+    return found;
+
+  const __m128i zero = _mm_setzero_si128();
+  for (const uint8_t* cursor = start_aligned; cursor != end_aligned;
+       cursor += sizeof(__m128i)) {
+    __m128i cmp = _mm_cmpeq_epi8(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(cursor)), zero);
+    unsigned long mask = ~_mm_movemask_epi8(cmp) & 0xFFFF;
+    if (mask != 0) {
+      unsigned long index = 0;
+      ::_BitScanForward(&index, mask);
+      return cursor + index;
+    }
+  }
+
+  return FindFirstNonZeroByte64(end_aligned, end);
+}
+
+void MarkAsFreedSse2(uint8_t* start, uint8_t* end) {
+  uint8_t* start_aligned = ::common::AlignUp(start, sizeof(__m128i));
+  uint8_t* end_aligned = ::common::AlignDown(end, sizeof(__m128i));
+  if (start_aligned > end_aligned) {
+    MarkAsFreed64(start, end);
+    return;
+  }
+  MarkAsFreed64(start, start_aligned);
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i freed = _mm_set1_epi8(static_cast<char>(kHeapFreedMarker));
+  for (uint8_t* cursor = start_aligned; cursor != end_aligned;
+       cursor += sizeof(__m128i)) {
+    __m128i* cursor128 = reinterpret_cast<__m128i*>(cursor);
+    __m128i cmp = _mm_cmpeq_epi8(_mm_load_si128(cursor128), zero);
+    if (_mm_movemask_epi8(cmp) == 0xFFFF) {
+      _mm_store_si128(cursor128, freed);
+    } else {
+      MarkAsFreed8(cursor, cursor + sizeof(__m128i));
+    }
+  }
+
+  MarkAsFreed64(end_aligned, end);
+}
+
+// @}
+
+// @name AVX2 kernels. These handle the unaligned head and tail of the range
+//     with the SSE2 kernels, and the rest with aligned 32-byte accesses. The
+//     upper halves of the YMM registers are cleared before returning to avoid
+//     AVX-SSE transition penalties.
+// @{
+
+bool IsZeroBufferAvx2(const uint8_t* start, const uint8_t* end) {
+  const uint8_t* start_aligned = ::common::AlignUp(start, sizeof(__m256i));
+  const uint8_t* end_aligned = ::common::AlignDown(end, sizeof(__m256i));
+  if (!IsZeroBufferSse2(start, start_aligned))
+    return false;
+
+  bool is_zero = true;
+  for (const __m256i* cursor = reinterpret_cast<const __m256i*>(start_aligned);
+       cursor != reinterpret_cast<const __m256i*>(end_aligned); ++cursor) {
+    __m256i value = _mm256_load_si256(cursor);
+    if (!_mm256_testz_si256(value, value)) {
+      is_zero = false;
+      break;
+    }
+  }
+  _mm256_zeroupper();
+
+  return is_zero && IsZeroBufferSse2(end_aligned, end);
+}
+
+const uint8_t* FindFirstNonZeroByteAvx2(const uint8_t* start,
+                                        const uint8_t* end) {
+  const uint8_t* start_aligned = ::common::AlignUp(start, sizeof(__m256i));
+  const uint8_t* end_aligned = ::common::AlignDown(end, sizeof(__m256i));
+  const uint8_t* found = FindFirstNonZeroByteSse2(start, start_aligned);
+  if (found != start_aligned)
+    return found;
+
+  found = nullptr;
+  const __m256i zero = _mm256_setzero_si256();
+  for (const uint8_t* cursor = start_aligned; cursor != end_aligned;
+       cursor += sizeof(__m256i)) {
+    __m256i cmp = _mm256_cmpeq_epi8(
+        _mm256_load_si256(reinterpret_cast<const __m256i*>(cursor)), zero);
+    unsigned long mask = ~static_cast<unsigned long>(_mm256_movemask_epi8(cmp));
+    if (mask != 0) {
+      unsigned long index = 0;
+      ::_BitScanForward(&index, mask);
+      found = cursor + index;
+      break;
+    }
+  }
+  _mm256_zeroupper();
+
+  if (found != nullptr)
+    return found;
+  return FindFirstNonZeroByteSse2(end_aligned, end);
+}
+
+void MarkAsFreedAvx2(uint8_t* start, uint8_t* end) {
+  uint8_t* start_aligned = ::common::AlignUp(start, sizeof(__m256i));
+  uint8_t* end_aligned = ::common::AlignDown(end, sizeof(__m256i));
+  MarkAsFreedSse2(start, start_aligned);
+
+  const __m256i freed = _mm256_set1_epi8(static_cast<char>(kHeapFreedMarker));
+  for (uint8_t* cursor = start_aligned; cursor != end_aligned;
+       cursor += sizeof(__m256i)) {
+    __m256i* cursor256 = reinterpret_cast<__m256i*>(cursor);
+    __m256i value = _mm256_load_si256(cursor256);
+    if (_mm256_testz_si256(value, value)) {
+      _mm256_store_si256(cursor256, freed);
+    } else {
+      MarkAsFreed8(cursor, cursor + sizeof(__m256i));
+    }
+  }
+  _mm256_zeroupper();
+
+  MarkAsFreedSse2(end_aligned, end);
+}
+
+// @}
+
+}  // namespace
+
+ShadowSimdLevel GetShadowSimdLevel() {
+  // This is racy, but all threads compute the same value.
+  LONG level = shadow_simd_level;
+  if (level < 0) {
+    level = DetectShadowSimdLevel();
+    shadow_simd_level = level;
+  }
+  return static_cast<ShadowSimdLevel>(level);
+}
+
+bool IsZeroBuffer(const uint8_t* start, const uint8_t* end) {
+  return IsZeroBuffer(GetShadowSimdLevel(), start, end);
+}
+
+const uint8_t* FindFirstNonZeroByte(const uint8_t* start, const uint8_t* end) {
+  return FindFirstNonZeroByte(GetShadowSimdLevel(), start, end);
+}
+
+void MarkAsFreed(uint8_t* start, uint8_t* end) {
+  MarkAsFreed(GetShadowSimdLevel(), start, end);
+}
+
+bool IsZeroBuffer(ShadowSimdLevel level,
+                  const uint8_t* start,
+                  const uint8_t* end) {
+  DCHECK_LE(start, end);
+  if (static_cast<size_t>(end - start) < kMinVectorRangeSize)
+    level = kShadowSimdNone;
+
+  switch (level) {
+    case kShadowSimdAvx2:
+      return IsZeroBufferAvx2(start, end);
+    case kShadowSimdSse2:
+      return IsZeroBufferSse2(start, end);
+    default:
+      return IsZeroBufferImpl<uint64_t>(start, end);
+  }
+}
+
+const uint8_t* FindFirstNonZeroByte(ShadowSimdLevel level,
+                                    const uint8_t* start,
+                                    const uint8_t* end) {
+  DCHECK_LE(start, end);
+  if (static_cast<size_t>(end - start) < kMinVectorRangeSize)
+    level = kShadowSimdNone;
+
+  switch (level) {
+    case kShadowSimdAvx2:
+      return FindFirstNonZeroByteAvx2(start, end);
+    case kShadowSimdSse2:
+      return FindFirstNonZeroByteSse2(start, end);
+    default:
+      return FindFirstNonZeroByte64(start, end);
+  }
+}
+
+void MarkAsFreed(ShadowSimdLevel level, uint8_t* start, uint8_t* end) {
+  DCHECK_LE(start, end);
+  if (static_cast<size_t>(end - start) < kMinVectorRangeSize)
+    level = kShadowSimdNone;
+
+  switch (level) {
+    case kShadowSimdAvx2:
+      MarkAsFreedAvx2(start, end);
+      return;
+    case kShadowSimdSse2:
+      MarkAsFreedSse2(start, end);
+      return;
+    default:
+      MarkAsFreed64(start, end);
+      return;
+  }
+}
+
+}  // namespace internal
+}  // namespace asan
+}  // namespace agent
@@ -0,0 +1,82 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Vectorized kernels used to scan and update ranges of shadow memory. The
+// best implementation supported by the processor is selected at runtime.
+
+#ifndef SYZYGY_AGENT_ASAN_SHADOW_SIMD_H_
+#define SYZYGY_AGENT_ASAN_SHADOW_SIMD_H_
+
+#include <stdint.h>
+
+namespace agent {
+namespace asan {
+namespace internal {
+
+// The instruction sets that the kernels can be implemented with.
+enum ShadowSimdLevel {
+  kShadowSimdNone,
+  kShadowSimdSse2,
+  kShadowSimdAvx2,
+};
+
+// @returns the best instruction set supported by the processor and the OS.
+//     This is computed once and cached.
+ShadowSimdLevel GetShadowSimdLevel();
+
+// @name Dispatched kernels. These use the level returned by
+//     GetShadowSimdLevel.
+// @{
+
+// Returns true iff every byte in the range [@p start, @p end) is zero. Like
+// IsZeroBufferImpl this may read memory surrounding the range, but never
+// crosses a 32-byte boundary in doing so.
+// @param start The first byte to test.
+// @param end The byte after the last byte to test.
+// @returns true iff every byte from @p *start to @p *(end - 1) is zero.
+bool IsZeroBuffer(const uint8_t* start, const uint8_t* end);
+
+// Finds the first non-zero byte of a range. This has the same read behaviour
+// as IsZeroBuffer.
+// @param start The first byte to test.
+// @param end The byte after the last byte to test.
+// @returns a pointer to the first non-zero byte in [@p start, @p end), or
+//     @p end if there is none.
+const uint8_t* FindFirstNonZeroByte(const uint8_t* start, const uint8_t* end);
+
+// Marks a range of shadow bytes as freed, preserving the active left and
+// right redzone markers found in the range.
+// @param start The first shadow byte to update.
+// @param end The byte after the last shadow byte to update.
+void MarkAsFreed(uint8_t* start, uint8_t* end);
+
+// @}
+
+// @name Implementations for a given level, exposed for unittesting. The level
+//     must be supported by the processor.
+// @{
+bool IsZeroBuffer(ShadowSimdLevel level,
+                  const uint8_t* start,
+                  const uint8_t* end);
+const uint8_t* FindFirstNonZeroByte(ShadowSimdLevel level,
+                                    const uint8_t* start,
+                                    const uint8_t* end);
+void MarkAsFreed(ShadowSimdLevel level, uint8_t* start, uint8_t* end);
+// @}
+
+}  // namespace internal
+}  // namespace asan
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_ASAN_SHADOW_SIMD_H_
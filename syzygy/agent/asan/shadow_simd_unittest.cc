@@ -0,0 +1,156 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/asan/shadow_simd.h"
+
+#include <vector>
+
+#include "base/compiler_specific.h"
+#include "base/macros.h"
+#include "base/rand_util.h"
+#include "gtest/gtest.h"
+#include "syzygy/agent/asan/shadow_marker.h"
+
+namespace agent {
+namespace asan {
+namespace internal {
+
+namespace {
+
+const size_t kBufSize = 512;
+
+// Returns the levels supported by the processor running the test.
+std::vector<ShadowSimdLevel> GetSupportedLevels() {
+  std::vector<ShadowSimdLevel> levels;
+  for (int level = kShadowSimdNone; level <= GetShadowSimdLevel(); ++level)
+    levels.push_back(static_cast<ShadowSimdLevel>(level));
+  return levels;
+}
+
+// A buffer aligned on a 32-byte boundary, so that all head and tail
+// alignments can be tested.
+struct AlignedBuffer {
+  ALIGNAS(32) uint8_t data[kBufSize];
+};
+
+}  // namespace
+
+TEST(ShadowSimdTest, GetShadowSimdLevel) {
+  ShadowSimdLevel level = GetShadowSimdLevel();
+  EXPECT_LE(kShadowSimdNone, level);
+  EXPECT_GE(kShadowSimdAvx2, level);
+
+  // This is cached, so subsequent calls return the same value.
+  EXPECT_EQ(level, GetShadowSimdLevel());
+
+  // All 64-bit processors support SSE2.
+#if defined(_WIN64)
+  EXPECT_LE(kShadowSimdSse2, level);
+#endif
+}
+
+TEST(ShadowSimdTest, IsZeroBuffer) {
+  AlignedBuffer buf = {};
+  for (ShadowSimdLevel level : GetSupportedLevels()) {
+    // Test all (mod 32) head and tail alignments, with ranges that are both
+    // shorter and longer than a vector.
+    for (size_t i = 0; i < 32; ++i) {
+      for (size_t j = 0; j < 32; ++j) {
+        uint8_t* start = buf.data + i;
+        uint8_t* end = buf.data + kBufSize - j;
+        ::memset(buf.data, 0xCC, kBufSize);
+        ::memset(start, 0, end - start);
+        EXPECT_TRUE(IsZeroBuffer(level, start, end));
+        EXPECT_TRUE(IsZeroBuffer(level, start, start));
+        EXPECT_TRUE(IsZeroBuffer(level, start, start + j));
+
+        // A non-zero byte anywhere in the range is detected.
+        for (uint8_t* cursor = start; cursor != end; ++cursor) {
+          *cursor = 1;
+          ASSERT_FALSE(IsZeroBuffer(level, start, end));
+          *cursor = 0;
+        }
+      }
+    }
+  }
+}
+
+TEST(ShadowSimdTest, FindFirstNonZeroByte) {
+  AlignedBuffer buf = {};
+  for (ShadowSimdLevel level : GetSupportedLevels()) {
+    for (size_t i = 0; i < 32; ++i) {
+      for (size_t j = 0; j < 32; ++j) {
+        uint8_t* start = buf.data + i;
+        uint8_t* end = buf.data + kBufSize - j;
+        ::memset(buf.data, 0xCC, kBufSize);
+        ::memset(start, 0, end - start);
+        EXPECT_EQ(end, FindFirstNonZeroByte(level, start, end));
+        EXPECT_EQ(start, FindFirstNonZeroByte(level, start, start));
+
+        // The first of two non-zero bytes is found.
+        for (uint8_t* cursor = start; cursor != end; ++cursor) {
+          *cursor = 1;
+          end[-1] = 2;
+          ASSERT_EQ(cursor, FindFirstNonZeroByte(level, start, end));
+          *cursor = 0;
+          end[-1] = 0;
+        }
+      }
+    }
+  }
+}
+
+TEST(ShadowSimdTest, MarkAsFreed) {
+  static const uint8_t kMarkers[] = {
+      kHeapAddressableMarker, kHeapAddressableMarker, kHeapAddressableMarker,
+      kHeapPartiallyAddressableByte3, kHeapLeftPaddingMarker,
+      kHeapRightPaddingMarker, kHeapBlockStartMarker0, kHeapBlockEndMarker,
+      kHeapHistoricLeftPaddingMarker, kHeapFreedMarker, kAsanReservedMarker };
+
+  AlignedBuffer buf = {};
+  AlignedBuffer expected = {};
+  for (ShadowSimdLevel level : GetSupportedLevels()) {
+    for (size_t i = 0; i < 32; ++i) {
+      for (size_t j = 0; j < 32; ++j) {
+        // Mostly green shadow memory, with some redzones sprinkled in.
+        for (size_t k = 0; k < kBufSize; ++k) {
+          buf.data[k] = kHeapAddressableMarker;
+          if (base::RandInt(0, 15) == 0)
+            buf.data[k] = kMarkers[base::RandInt(0, arraysize(kMarkers) - 1)];
+        }
+        ::memcpy(expected.data, buf.data, kBufSize);
+        MarkAsFreed(kShadowSimdNone, expected.data + i,
+                    expected.data + kBufSize - j);
+
+        MarkAsFreed(level, buf.data + i, buf.data + kBufSize - j);
+        ASSERT_EQ(0, ::memcmp(expected.data, buf.data, kBufSize));
+      }
+    }
+  }
+
+  // Check the reference implementation itself.
+  buf.data[0] = kHeapAddressableMarker;
+  buf.data[1] = kHeapLeftPaddingMarker;
+  buf.data[2] = kHeapRightPaddingMarker;
+  buf.data[3] = kHeapPartiallyAddressableByte3;
+  MarkAsFreed(kShadowSimdNone, buf.data, buf.data + 4);
+  EXPECT_EQ(kHeapFreedMarker, buf.data[0]);
+  EXPECT_EQ(kHeapLeftPaddingMarker, buf.data[1]);
+  EXPECT_EQ(kHeapRightPaddingMarker, buf.data[2]);
+  EXPECT_EQ(kHeapFreedMarker, buf.data[3]);
+}
+
+}  // namespace internal
+}  // namespace asan
+}  // namespace agent
@@ -20,6 +20,7 @@
 #include "base/strings/stringprintf.h"
 #include "gtest/gtest.h"
 #include "syzygy/common/align.h"
+#include "syzygy/common/large_pages.h"
 #include "syzygy/testing/metrics.h"
 
 namespace agent {
@@ -653,6 +654,228 @@ TEST_F(ShadowTest, PageBits) {
 
 namespace {
 
+// The amount of memory described by a byte of the shadow summary.
+const size_t kSummarizedMemorySize = Shadow::kShadowSummaryRatio * kShadowRatio;
+
+Shadow::ShadowSummaryState GetSummaryState(const Shadow& shadow,
+                                           const void* addr) {
+  return shadow.GetShadowSummaryState(reinterpret_cast<uintptr_t>(addr) >>
+                                      kShadowRatioLog);
+}
+
+}  // namespace
+
+TEST_F(ShadowTest, ShadowSummary) {
+  const size_t kMemorySize = 8 * kSummarizedMemorySize;
+  uint8_t* mem = static_cast<uint8_t*>(
+      ::VirtualAlloc(nullptr, kMemorySize, MEM_RESERVE, PAGE_NOACCESS));
+  ASSERT_NE(static_cast<uint8_t*>(nullptr), mem);
+  ASSERT_TRUE(::common::IsAligned(mem, kSummarizedMemorySize));
+  for (size_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(Shadow::kShadowSummaryAccessible,
+              GetSummaryState(test_shadow, mem + i * kSummarizedMemorySize));
+  }
+
+  // Fully covered ranges get summarized.
+  test_shadow.Poison(mem, kMemorySize, kAsanReservedMarker);
+  for (size_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(Shadow::kShadowSummaryPoisoned,
+              GetSummaryState(test_shadow, mem + i * kSummarizedMemorySize));
+  }
+  EXPECT_FALSE(test_shadow.IsRangeAccessible(mem, kMemorySize));
+  EXPECT_EQ(mem, test_shadow.FindFirstPoisonedByte(mem, kMemorySize));
+
+  uint8_t* mem1 = mem + kSummarizedMemorySize;
+  uint8_t* mem3 = mem + 3 * kSummarizedMemorySize;
+  test_shadow.Unpoison(mem1, 2 * kSummarizedMemorySize);
+  EXPECT_EQ(Shadow::kShadowSummaryPoisoned, GetSummaryState(test_shadow, mem));
+  EXPECT_EQ(Shadow::kShadowSummaryAccessible,
+            GetSummaryState(test_shadow, mem1));
+  EXPECT_EQ(Shadow::kShadowSummaryAccessible,
+            GetSummaryState(test_shadow, mem1 + kSummarizedMemorySize));
+  EXPECT_EQ(Shadow::kShadowSummaryPoisoned, GetSummaryState(test_shadow, mem3));
+  EXPECT_TRUE(test_shadow.IsRangeAccessible(mem1, 2 * kSummarizedMemorySize));
+  EXPECT_FALSE(
+      test_shadow.IsRangeAccessible(mem1, 2 * kSummarizedMemorySize + 1));
+  EXPECT_FALSE(
+      test_shadow.IsRangeAccessible(mem1 - 1, 2 * kSummarizedMemorySize));
+  EXPECT_EQ(mem3, test_shadow.FindFirstPoisonedByte(
+                      mem1, 3 * kSummarizedMemorySize));
+  EXPECT_EQ(mem1 - 1, test_shadow.FindFirstPoisonedByte(
+                          mem1 - 1, 3 * kSummarizedMemorySize));
+
+  // Poisoning a part of an accessible range makes it mixed, and the result of
+  // the range checks reflects the actual shadow.
+  uint8_t* poisoned = mem1 + kSummarizedMemorySize / 2;
+  test_shadow.Poison(poisoned, kShadowRatio, kHeapLeftPaddingMarker);
+  EXPECT_EQ(Shadow::kShadowSummaryMixed, GetSummaryState(test_shadow, mem1));
+  EXPECT_FALSE(test_shadow.IsRangeAccessible(mem1, 2 * kSummarizedMemorySize));
+  EXPECT_EQ(poisoned, test_shadow.FindFirstPoisonedByte(
+                          mem1, 2 * kSummarizedMemorySize));
+
+  // Poisoning with a different redzone marker keeps a range poisoned, but a
+  // partial unpoisoning doesn't.
+  test_shadow.Poison(mem3 + kShadowRatio, kShadowRatio, kHeapFreedMarker);
+  EXPECT_EQ(Shadow::kShadowSummaryPoisoned, GetSummaryState(test_shadow, mem3));
+  test_shadow.Unpoison(mem3 + kShadowRatio, kShadowRatio);
+  EXPECT_EQ(Shadow::kShadowSummaryMixed, GetSummaryState(test_shadow, mem3));
+
+  // Block markers are never summarized.
+  test_shadow.Poison(mem1, 2 * kSummarizedMemorySize,
+                     ShadowMarkerHelper::BuildBlockEnd(true));
+  EXPECT_EQ(Shadow::kShadowSummaryMixed, GetSummaryState(test_shadow, mem1));
+  EXPECT_EQ(Shadow::kShadowSummaryMixed,
+            GetSummaryState(test_shadow, mem1 + kSummarizedMemorySize));
+
+  // Marking memory as freed can't be summarized either.
+  test_shadow.Unpoison(mem, kMemorySize);
+  EXPECT_EQ(Shadow::kShadowSummaryAccessible,
+            GetSummaryState(test_shadow, mem));
+  test_shadow.MarkAsFreed(mem, kSummarizedMemorySize);
+  EXPECT_EQ(Shadow::kShadowSummaryMixed, GetSummaryState(test_shadow, mem));
+
+  test_shadow.Unpoison(mem, kMemorySize);
+  ::VirtualFree(mem, 0, MEM_RELEASE);
+}
+
+TEST_F(ShadowTest, ShadowSummaryOfLargeBlock) {
+  BlockLayout layout = {};
+  EXPECT_TRUE(BlockPlanLayout(kShadowRatio, kShadowRatio,
+                              4 * kSummarizedMemorySize + 3, 0, 0, &layout));
+
+  uint8_t* data = static_cast<uint8_t*>(::VirtualAlloc(
+      nullptr, layout.block_size, MEM_COMMIT, PAGE_READWRITE));
+  ASSERT_NE(static_cast<uint8_t*>(nullptr), data);
+  BlockInfo info = {};
+  BlockInitialize(layout, data, &info);
+  test_shadow.PoisonAllocatedBlock(info);
+
+  // The ranges containing the block's redzones are mixed, and the ones in
+  // its body are accessible.
+  EXPECT_EQ(Shadow::kShadowSummaryMixed,
+            GetSummaryState(test_shadow, info.RawHeader()));
+  EXPECT_EQ(Shadow::kShadowSummaryMixed,
+            GetSummaryState(test_shadow, info.RawTrailer()));
+  for (size_t i = 1; i < 4; ++i) {
+    EXPECT_EQ(Shadow::kShadowSummaryAccessible,
+              GetSummaryState(test_shadow,
+                              info.RawHeader() + i * kSummarizedMemorySize));
+  }
+  EXPECT_TRUE(test_shadow.IsRangeAccessible(info.body, info.body_size));
+  EXPECT_FALSE(test_shadow.IsRangeAccessible(info.body, info.body_size + 1));
+  EXPECT_EQ(info.RawBody() + info.body_size,
+            test_shadow.FindFirstPoisonedByte(info.body, info.block_size));
+
+  // A string spanning the entire body is found.
+  ::memset(info.body, 'a', info.body_size);
+  info.RawBody()[info.body_size - 1] = 0;
+  size_t size = 0;
+  EXPECT_TRUE(test_shadow.GetNullTerminatedArraySize<uint8_t>(
+      info.body, 0U, &size));
+  EXPECT_EQ(info.body_size, size);
+  info.RawBody()[info.body_size - 1] = 'a';
+  EXPECT_FALSE(test_shadow.GetNullTerminatedArraySize<uint8_t>(
+      info.body, 0U, &size));
+
+  // The block is found when walking over the summarized ranges.
+  ShadowWalker walker(&test_shadow, data - 2 * kSummarizedMemorySize,
+                      data + layout.block_size + 2 * kSummarizedMemorySize);
+  BlockInfo walked_info = {};
+  EXPECT_TRUE(walker.Next(&walked_info));
+  EXPECT_EQ(info.header, walked_info.header);
+  EXPECT_EQ(info.block_size, walked_info.block_size);
+  EXPECT_FALSE(walker.Next(&walked_info));
+
+  test_shadow.Unpoison(info.RawBlock(), info.block_size);
+  ::VirtualFree(data, 0, MEM_RELEASE);
+}
+
+TEST_F(ShadowTest, ReleaseMemory) {
+  const size_t kMemorySize = 1024 * 1024;
+  uint8_t* mem = static_cast<uint8_t*>(
+      ::VirtualAlloc(nullptr, kMemorySize, MEM_RESERVE, PAGE_NOACCESS));
+  ASSERT_NE(static_cast<uint8_t*>(nullptr), mem);
+  const uint8_t* mem_shadow = test_shadow.GetShadowMemoryForAddress(mem);
+  const size_t kShadowSize = kMemorySize / kShadowRatio;
+
+  EXPECT_FALSE(test_shadow.decommit_released_memory());
+  test_shadow.set_decommit_released_memory(true);
+  EXPECT_TRUE(test_shadow.decommit_released_memory());
+
+  // Release a range that doesn't fully cover any page of shadow.
+  const size_t kSmallSize = GetPageSize();
+  test_shadow.Poison(mem, kSmallSize, kAsanReservedMarker);
+  test_shadow.ReleaseMemory(mem, kSmallSize);
+  EXPECT_TRUE(test_shadow.IsRangeAccessible(mem, kSmallSize));
+
+  test_shadow.Poison(mem, kMemorySize, kAsanReservedMarker);
+  EXPECT_FALSE(test_shadow.IsAccessible(mem + kMemorySize / 2));
+
+#ifdef _WIN64
+  // The shadow for the range is now committed.
+  MEMORY_BASIC_INFORMATION info = {};
+  ASSERT_NE(0u, ::VirtualQuery(mem_shadow, &info, sizeof(info)));
+  EXPECT_EQ(MEM_COMMIT, info.State);
+  EXPECT_LE(mem_shadow + kShadowSize,
+            static_cast<uint8_t*>(info.BaseAddress) + info.RegionSize);
+#endif
+
+  test_shadow.ReleaseMemory(mem, kMemorySize);
+  EXPECT_TRUE(test_shadow.IsRangeAccessible(mem, kMemorySize));
+
+#ifdef _WIN64
+  // The shadow for the range has been given back to the OS.
+  ASSERT_NE(0u, ::VirtualQuery(mem_shadow, &info, sizeof(info)));
+  EXPECT_NE(MEM_COMMIT, info.State);
+  EXPECT_LE(mem_shadow + kShadowSize,
+            static_cast<uint8_t*>(info.BaseAddress) + info.RegionSize);
+#endif
+
+  // The shadow can be used again.
+  for (size_t i = 0; i < kShadowSize; i += GetPageSize())
+    EXPECT_EQ(kHeapAddressableMarker, mem_shadow[i]);
+  test_shadow.Poison(mem, kMemorySize, kAsanReservedMarker);
+  EXPECT_FALSE(test_shadow.IsAccessible(mem + kMemorySize / 2));
+
+  // Nothing is decommitted when this is disabled.
+  test_shadow.set_decommit_released_memory(false);
+  test_shadow.ReleaseMemory(mem, kMemorySize);
+  EXPECT_TRUE(test_shadow.IsRangeAccessible(mem, kMemorySize));
+#ifdef _WIN64
+  ASSERT_NE(0u, ::VirtualQuery(mem_shadow, &info, sizeof(info)));
+  EXPECT_EQ(MEM_COMMIT, info.State);
+#endif
+
+  ::VirtualFree(mem, 0, MEM_RELEASE);
+}
+
+TEST(ShadowLargePagesTest, FallsBackGracefully) {
+  // Enough shadow for 64MB of memory.
+  const size_t kLength = 8 * 1024 * 1024;
+  Shadow shadow(kLength, true);
+  ASSERT_NE(static_cast<uint8_t*>(nullptr), shadow.shadow());
+  EXPECT_EQ(kLength, shadow.length());
+
+  // Large pages are only used when the privilege is held, and never for the
+  // sparse 64-bit shadow.
+#ifdef _WIN64
+  EXPECT_FALSE(shadow.large_pages());
+#else
+  if (::common::EnableLargePages() == 0)
+    EXPECT_FALSE(shadow.large_pages());
+#endif
+
+  // The shadow is usable either way.
+  uint8_t* addr = reinterpret_cast<uint8_t*>(0x1000000);
+  EXPECT_TRUE(shadow.IsAccessible(addr));
+  shadow.Poison(addr, kShadowRatio, kAsanReservedMarker);
+  EXPECT_FALSE(shadow.IsAccessible(addr));
+  shadow.Unpoison(addr, kShadowRatio);
+  EXPECT_TRUE(shadow.IsAccessible(addr));
+}
+
+namespace {
+
 // A fixture for shadow walker tests.
 class ShadowWalkerTest : public testing::Test {
  public:
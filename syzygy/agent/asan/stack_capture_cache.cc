@@ -14,7 +14,10 @@
 
 #include "syzygy/agent/asan/stack_capture_cache.h"
 
+#include <windows.h>
+
 #include <algorithm>
+#include <vector>
 
 #include "base/lazy_instance.h"
 #include "base/logging.h"
@@ -42,8 +45,333 @@ common::StackCapture** GetFirstFrameAsLink(
   return link;
 }
 
+class PrivateStackCapture : public common::StackCapture {
+ public:
+  // Expose the actual number of frames. We use this to make reclaimed
+  // stack captures look invalid when they're in a free list.
+  using common::StackCapture::num_frames_;
+  // Expose the reference count, so that it can be updated atomically.
+  using common::StackCapture::ref_count_;
+
+  // Initializes this stack capture with the compact form of an existing stack
+  // trace.
+  // @param stack_capture The existing stack trace. Its relative stack ID must
+  //     already have been computed.
+  // @param encoded_frames The encoded frames of @p stack_capture.
+  // @param encoded_size The size of @p encoded_frames, in bytes.
+  void InitCompactFromExistingStack(const common::StackCapture& stack_capture,
+                                    const uint8_t* encoded_frames,
+                                    size_t encoded_size) {
+    DCHECK_LT(max_num_frames_, stack_capture.num_frames());
+    DCHECK_GE(max_num_frames_ * sizeof(frames_[0]), encoded_size);
+    num_frames_ = static_cast<uint8_t>(stack_capture.num_frames());
+    absolute_stack_id_ = stack_capture.absolute_stack_id();
+    relative_stack_id_ = stack_capture.relative_stack_id();
+    uint8_t* data = reinterpret_cast<uint8_t*>(frames_);
+    ::memcpy(data, encoded_frames, encoded_size);
+    ::memset(data + encoded_size, 0,
+             max_num_frames_ * sizeof(frames_[0]) - encoded_size);
+  }
+};
+
+// The maximum size of a frame in compact form, in bytes.
+const size_t kMaxEncodedFrameSize = (sizeof(uintptr_t) * 8 + 6) / 7;
+
+// Encodes stack frames in compact form. Each frame is stored as the difference
+// with the previous frame, zigzag encoded so that small negative differences
+// remain small, as a base-128 varint. The frames of a stack mostly lie in a few
+// modules, so most of them fit in 3 or 4 bytes.
+// @param frames The frames to encode.
+// @param num_frames The number of frames to encode.
+// @param buffer Will receive the encoded frames. This must be able to hold
+//     @p num_frames * kMaxEncodedFrameSize bytes.
+// @returns the number of bytes written to @p buffer.
+size_t EncodeFrames(const void* const* frames,
+                    size_t num_frames,
+                    uint8_t* buffer) {
+  DCHECK_NE(static_cast<const void* const*>(nullptr), frames);
+  DCHECK_NE(static_cast<uint8_t*>(nullptr), buffer);
+  uint8_t* cursor = buffer;
+  uintptr_t previous = 0;
+  for (size_t i = 0; i < num_frames; ++i) {
+    uintptr_t frame = reinterpret_cast<uintptr_t>(frames[i]);
+    intptr_t delta = static_cast<intptr_t>(frame - previous);
+    uintptr_t value = (static_cast<uintptr_t>(delta) << 1) ^
+                      static_cast<uintptr_t>(delta >> (sizeof(delta) * 8 - 1));
+    previous = frame;
+    while (value >= 0x80) {
+      *cursor++ = static_cast<uint8_t>(value | 0x80);
+      value >>= 7;
+    }
+    *cursor++ = static_cast<uint8_t>(value);
+  }
+  return static_cast<size_t>(cursor - buffer);
+}
+
+// Decodes stack frames encoded by EncodeFrames.
+// @param buffer The encoded frames.
+// @param num_frames The number of frames to decode.
+// @param frames Will receive the decoded frames.
+void DecodeFrames(const uint8_t* buffer, size_t num_frames, void** frames) {
+  DCHECK_NE(static_cast<const uint8_t*>(nullptr), buffer);
+  DCHECK_NE(static_cast<void**>(nullptr), frames);
+  uintptr_t previous = 0;
+  for (size_t i = 0; i < num_frames; ++i) {
+    uintptr_t value = 0;
+    size_t shift = 0;
+    uint8_t byte = 0;
+    do {
+      byte = *buffer++;
+      value |= static_cast<uintptr_t>(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    previous += (value >> 1) ^ (0 - (value & 1));
+    frames[i] = reinterpret_cast<void*>(previous);
+  }
+}
+
+// @returns the number of frame slots used by the frames of a saved stack
+//     capture.
+size_t GetNumFrameSlotsUsed(const common::StackCapture* stack_capture) {
+  if (StackCaptureCache::IsCompact(stack_capture))
+    return stack_capture->max_num_frames();
+  return stack_capture->num_frames();
+}
+
+// The value of the slots of a KnownStacks table whose stack capture has been
+// removed.
+common::StackCapture* const kDeletedSlot =
+    reinterpret_cast<common::StackCapture*>(1);
+
+// Gives us access to the reference count of a stack capture as an interlocked
+// variable.
+volatile SHORT* GetRefCount(common::StackCapture* stack_capture) {
+  static_assert(sizeof(common::StackCapture::RefCount) == sizeof(SHORT),
+                "Reference count can't be updated atomically.");
+  return reinterpret_cast<volatile SHORT*>(
+      &reinterpret_cast<PrivateStackCapture*>(stack_capture)->ref_count_);
+}
+
+// Atomically adds a reference to a stack capture. This uses the same
+// saturation arithmetic as StackCapture::AddRef.
+// @param stack_capture The stack capture to reference.
+// @param allow_unreferenced If false, a stack capture that has no references is
+//     left untouched.
+// @returns true if a reference was added or the reference count is saturated,
+//     false otherwise.
+bool InterlockedAddRef(common::StackCapture* stack_capture,
+                       bool allow_unreferenced) {
+  volatile SHORT* ref_count = GetRefCount(stack_capture);
+  while (true) {
+    SHORT old_value = *ref_count;
+    auto count = static_cast<common::StackCapture::RefCount>(old_value);
+    if (count == common::StackCapture::kMaxRefCount)
+      return true;
+    if (count == 0 && !allow_unreferenced)
+      return false;
+    SHORT new_value = static_cast<SHORT>(count + 1);
+    if (::InterlockedCompareExchange16(ref_count, new_value, old_value) ==
+        old_value) {
+      return true;
+    }
+  }
+}
+
+// Atomically removes a reference from a stack capture. This uses the same
+// saturation arithmetic as StackCapture::RemoveRef.
+// @param stack_capture The stack capture to dereference.
+// @returns true if the last reference was removed, false otherwise.
+bool InterlockedRemoveRef(common::StackCapture* stack_capture) {
+  volatile SHORT* ref_count = GetRefCount(stack_capture);
+  while (true) {
+    SHORT old_value = *ref_count;
+    auto count = static_cast<common::StackCapture::RefCount>(old_value);
+    DCHECK_LT(0u, count);
+    if (count == common::StackCapture::kMaxRefCount)
+      return false;
+    SHORT new_value = static_cast<SHORT>(count - 1);
+    if (::InterlockedCompareExchange16(ref_count, new_value, old_value) ==
+        old_value) {
+      return count == 1;
+    }
+  }
+}
+
 }  // namespace
 
+struct StackCaptureCache::KnownStacks::Table {
+  // The table that this one replaced. It is kept alive as lock-free readers
+  // may still be probing it.
+  Table* retired;
+  // The number of slots, which is a power of two.
+  size_t capacity;
+  // The size of the allocation containing this table.
+  size_t allocation_size;
+  // The slots. These are nullptr when empty and kDeletedSlot when their stack
+  // capture has been removed. This is a runtime dynamic array whose actual
+  // length is |capacity|.
+  common::StackCapture* volatile slots[1];
+};
+
+StackCaptureCache::KnownStacks::KnownStacks(
+    MemoryNotifierInterface* memory_notifier)
+    : memory_notifier_(memory_notifier), table_(nullptr), size_(0), used_(0) {
+  DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
+}
+
+StackCaptureCache::KnownStacks::~KnownStacks() {
+  Table* table = table_;
+  while (table != nullptr) {
+    Table* retired = table->retired;
+    FreeTable(table);
+    table = retired;
+  }
+}
+
+common::StackCapture* StackCaptureCache::KnownStacks::Find(
+    StackId stack_id) const {
+  const Table* table = table_;
+  if (table == nullptr)
+    return nullptr;
+
+  // The stack ID is already a hash, but its low bits select the shard.
+  size_t mask = table->capacity - 1;
+  size_t index = (stack_id / kKnownStacksSharding) & mask;
+  for (size_t i = 0; i < table->capacity; ++i) {
+    common::StackCapture* stack_capture = table->slots[index];
+    if (stack_capture == nullptr)
+      return nullptr;
+    // Stack captures are never freed, so this is safe to read even if the
+    // stack capture has been concurrently removed.
+    if (stack_capture != kDeletedSlot &&
+        stack_capture->absolute_stack_id() == stack_id) {
+      return stack_capture;
+    }
+    index = (index + 1) & mask;
+  }
+  return nullptr;
+}
+
+void StackCaptureCache::KnownStacks::Insert(
+    common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  DCHECK_EQ(static_cast<common::StackCapture*>(nullptr),
+            Find(stack_capture->absolute_stack_id()));
+
+  // Keep at least a quarter of the slots empty, so that probe sequences stay
+  // short and always terminate.
+  if (table_ == nullptr || (used_ + 1) * 4 > table_->capacity * 3)
+    Rehash();
+
+  if (InsertImpl(table_, stack_capture))
+    ++used_;
+  ++size_;
+}
+
+bool StackCaptureCache::KnownStacks::Erase(common::StackCapture* stack_capture,
+                                           StackId stack_id) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  Table* table = table_;
+  if (table == nullptr)
+    return false;
+
+  size_t mask = table->capacity - 1;
+  size_t index = (stack_id / kKnownStacksSharding) & mask;
+  for (size_t i = 0; i < table->capacity; ++i) {
+    common::StackCapture* slot = table->slots[index];
+    if (slot == nullptr)
+      return false;
+    if (slot == stack_capture) {
+      // The slot can't be emptied as this would break the probe sequences
+      // going through it.
+      table->slots[index] = kDeletedSlot;
+      --size_;
+      return true;
+    }
+    index = (index + 1) & mask;
+  }
+  return false;
+}
+
+StackCaptureCache::KnownStacks::Table*
+StackCaptureCache::KnownStacks::AllocateTable(size_t capacity) {
+  DCHECK(::common::IsPowerOfTwo(capacity));
+  size_t size = sizeof(Table) + (capacity - 1) * sizeof(Table::slots[0]);
+  size = ::common::AlignUp(size, GetPageSize());
+
+  // Zero filled memory is a table of empty slots.
+  Table* table = static_cast<Table*>(
+      ::VirtualAlloc(nullptr, size, MEM_COMMIT, PAGE_READWRITE));
+  CHECK_NE(static_cast<Table*>(nullptr), table);
+  memory_notifier_->NotifyInternalUse(table, size);
+
+  table->retired = nullptr;
+  table->capacity = capacity;
+  table->allocation_size = size;
+  return table;
+}
+
+void StackCaptureCache::KnownStacks::FreeTable(Table* table) {
+  DCHECK_NE(static_cast<Table*>(nullptr), table);
+  memory_notifier_->NotifyReturnedToOS(table, table->allocation_size);
+  CHECK_EQ(TRUE, ::VirtualFree(table, 0, MEM_RELEASE));
+}
+
+void StackCaptureCache::KnownStacks::Rehash() {
+  if (table_ == nullptr) {
+    table_ = AllocateTable(kInitialCapacity);
+    return;
+  }
+
+  // If the table is mostly full of deleted slots then it is cleaned up in
+  // place. Lock-free readers may then miss some stack captures, but they
+  // confirm their misses under the lock.
+  Table* table = table_;
+  if ((size_ + 1) * 2 <= table->capacity) {
+    std::vector<common::StackCapture*> stack_captures;
+    stack_captures.reserve(size_);
+    for (size_t i = 0; i < table->capacity; ++i) {
+      common::StackCapture* slot = table->slots[i];
+      if (slot != nullptr && slot != kDeletedSlot)
+        stack_captures.push_back(slot);
+      table->slots[i] = nullptr;
+    }
+    for (auto stack_capture : stack_captures)
+      InsertImpl(table, stack_capture);
+    used_ = size_;
+    return;
+  }
+
+  // Otherwise the stack captures are moved to a table twice as big, which is
+  // then published.
+  Table* new_table = AllocateTable(table->capacity * 2);
+  for (size_t i = 0; i < table->capacity; ++i) {
+    common::StackCapture* slot = table->slots[i];
+    if (slot != nullptr && slot != kDeletedSlot)
+      InsertImpl(new_table, slot);
+  }
+  new_table->retired = table;
+  table_ = new_table;
+  used_ = size_;
+}
+
+// static
+bool StackCaptureCache::KnownStacks::InsertImpl(
+    Table* table, common::StackCapture* stack_capture) {
+  DCHECK_NE(static_cast<Table*>(nullptr), table);
+  size_t mask = table->capacity - 1;
+  size_t index = (stack_capture->absolute_stack_id() / kKnownStacksSharding) &
+      mask;
+  while (true) {
+    common::StackCapture* slot = table->slots[index];
+    if (slot == nullptr || slot == kDeletedSlot) {
+      table->slots[index] = stack_capture;
+      return slot == nullptr;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
 size_t StackCaptureCache::compression_reporting_period_ =
     ::common::kDefaultReportingPeriod;
 
@@ -110,10 +438,16 @@ StackCaptureCache::StackCaptureCache(
     : logger_(logger),
       memory_notifier_(memory_notifier),
       max_num_frames_(common::StackCapture::kMaxNumFrames),
-      current_page_(nullptr) {
+      compact_frames_(false),
+      current_page_(nullptr),
+      request_count_(0),
+      hit_count_(0) {
   DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
 
+  for (size_t i = 0; i < kKnownStacksSharding; ++i)
+    known_stacks_[i] = new KnownStacks(memory_notifier);
+
   AllocateCachePage();
 
   ::memset(&statistics_, 0, sizeof(statistics_));
@@ -127,13 +461,19 @@ StackCaptureCache::StackCaptureCache(
     : logger_(logger),
       memory_notifier_(memory_notifier),
       max_num_frames_(0),
-      current_page_(nullptr) {
+      compact_frames_(false),
+      current_page_(nullptr),
+      request_count_(0),
+      hit_count_(0) {
   DCHECK_NE(static_cast<AsanLogger*>(nullptr), logger);
   DCHECK_NE(static_cast<MemoryNotifierInterface*>(nullptr), memory_notifier);
   DCHECK_LT(0u, max_num_frames);
   max_num_frames_ = static_cast<uint8_t>(
       std::min(max_num_frames, common::StackCapture::kMaxNumFrames));
 
+  for (size_t i = 0; i < kKnownStacksSharding; ++i)
+    known_stacks_[i] = new KnownStacks(memory_notifier);
+
   AllocateCachePage();
   ::memset(&statistics_, 0, sizeof(statistics_));
   ::memset(reclaimed_, 0, sizeof(reclaimed_));
@@ -141,6 +481,9 @@ StackCaptureCache::StackCaptureCache(
 }
 
 StackCaptureCache::~StackCaptureCache() {
+  for (size_t i = 0; i < kKnownStacksSharding; ++i)
+    delete known_stacks_[i];
+
   // Clean up the linked list of cache pages.
   while (current_page_ != nullptr) {
     CachePage* page = current_page_;
@@ -177,40 +520,87 @@ const common::StackCapture* StackCaptureCache::SaveStackTrace(
   common::StackCapture* stack_trace = nullptr;
   bool saturated = false;
 
-  {
-    size_t known_stack_shard = absolute_stack_id % kKnownStacksSharding;
+  size_t known_stack_shard = absolute_stack_id % kKnownStacksSharding;
+  KnownStacks* known_stacks = known_stacks_[known_stack_shard];
+
+  // Look for the stack capture without taking the lock. The result is only a
+  // hint, but a stack capture that is referenced and has the right ID after
+  // having been referenced can't be removed from the cache or reused, and
+  // there can only be one of them.
+  stack_trace = known_stacks->Find(absolute_stack_id);
+  if (stack_trace != nullptr) {
+    saturated = stack_trace->RefCountIsSaturated();
+    if (!InterlockedAddRef(stack_trace, false)) {
+      // The stack capture is being removed from the cache.
+      stack_trace = nullptr;
+    } else if (stack_trace->absolute_stack_id() != absolute_stack_id) {
+      // The stack capture has been reused for another stack.
+      ReleaseStackTraceImpl(stack_trace, false);
+      stack_trace = nullptr;
+    } else {
+      already_cached = true;
+    }
+  }
+
+  // If the stack may be stored in compact form then its frames are encoded
+  // outside of the lock. Compact stack captures can't compute their relative
+  // stack ID, so it is computed here as well. This looks up the modules
+  // containing the frames, which must not be done under the lock.
+  uint8_t encoded_frames[common::StackCapture::kMaxNumFrames *
+                         kMaxEncodedFrameSize];
+  size_t encoded_size = 0;
+  size_t num_frame_slots = num_frames;
+  if (!already_cached && compact_frames_) {
+    stack_capture.relative_stack_id();
+    encoded_size = EncodeFrames(frames, num_frames, encoded_frames);
+    num_frame_slots = ::common::AlignUp(encoded_size, sizeof(frames[0])) /
+                      sizeof(frames[0]);
+  }
+
+  if (!already_cached) {
     // Get or insert the current stack trace while under the lock for this
     // bucket.
     base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
 
-    // Check if the stack capture is already in the cache map.
-    StackMap::iterator result =
-        known_stacks_[known_stack_shard].find(absolute_stack_id);
+    // Check again if the stack capture is already in the cache. This can find
+    // a stack capture that has just lost its last reference, in which case it
+    // will be kept.
+    stack_trace = known_stacks->Find(absolute_stack_id);
 
     // If this capture has not already been cached then we have to initialize
     // the data.
-    if (result == known_stacks_[known_stack_shard].end()) {
-      stack_trace = GetStackCapture(num_frames);
+    if (stack_trace == nullptr) {
+      // The compact form is only used if it is smaller, and if the stack
+      // capture can't hold the frames as they are.
+      if (num_frame_slots < num_frames) {
+        stack_trace = GetStackCapture(num_frame_slots);
+      } else {
+        stack_trace = GetStackCapture(num_frames);
+      }
       DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
-      stack_trace->InitFromExistingStack(stack_capture);
-      auto result = known_stacks_[known_stack_shard].insert(
-          std::make_pair(absolute_stack_id, stack_trace));
-      DCHECK(result.second);
+      if (stack_trace->max_num_frames() < num_frames) {
+        reinterpret_cast<PrivateStackCapture*>(stack_trace)
+            ->InitCompactFromExistingStack(stack_capture, encoded_frames,
+                                           encoded_size);
+      } else {
+        stack_trace->InitFromExistingStack(stack_capture);
+      }
+      known_stacks->Insert(stack_trace);
       DCHECK(stack_trace->HasNoRefs());
       FOR_EACH_OBSERVER(Observer, observer_list_, OnNewStack(stack_trace));
     } else {
       already_cached = true;
-      stack_trace = result->second;
     }
     // Increment the reference count for this stack trace.
-    if (!stack_trace->RefCountIsSaturated()) {
-      stack_trace->AddRef();
-    } else {
-      saturated = true;
-    }
+    saturated = stack_trace->RefCountIsSaturated();
+    InterlockedAddRef(stack_trace, true);
   }
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_trace);
 
+  base::subtle::NoBarrier_AtomicIncrement(&request_count_, 1);
+  if (already_cached)
+    base::subtle::NoBarrier_AtomicIncrement(&hit_count_, 1);
+
   bool must_log = false;
   Statistics statistics = {};
   // Update the statistics.
@@ -225,7 +615,7 @@ const common::StackCapture* StackCaptureCache::SaveStackTrace(
       }
     } else {
       ++statistics_.cached;
-      statistics_.frames_alive += num_frames;
+      statistics_.frames_alive += GetNumFrameSlotsUsed(stack_trace);
       ++statistics_.allocated;
     }
     if (!saturated && stack_trace->RefCountIsSaturated()) {
@@ -257,40 +647,49 @@ void StackCaptureCache::ReleaseStackTrace(
     return;
   }
 
-  size_t known_stack_shard =
-      stack_capture->absolute_stack_id() % kKnownStacksSharding;
-  bool add_to_reclaimed_list = false;
-  common::StackCapture* stack = nullptr;
-  {
-    base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
+  // We own the stack so its fine to remove the const. We double check this
+  // is the case in debug builds with the DCHECK.
+  ReleaseStackTraceImpl(const_cast<common::StackCapture*>(stack_capture),
+                        true);
+}
+
+void StackCaptureCache::ReleaseStackTraceImpl(
+    common::StackCapture* stack_capture, bool is_referenced) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
 
-    // We own the stack so its fine to remove the const. We double check this
-    // is the case in debug builds with the DCHECK.
-    stack = const_cast<common::StackCapture*>(stack_capture);
+  // The identity of the stack capture is stable while a reference is held.
+  StackId absolute_stack_id = stack_capture->absolute_stack_id();
+  size_t num_frames = stack_capture->num_frames();
+  size_t num_frame_slots = GetNumFrameSlotsUsed(stack_capture);
 
-    stack->RemoveRef();
+  bool add_to_reclaimed_list = false;
+  if (InterlockedRemoveRef(stack_capture)) {
+    size_t known_stack_shard = absolute_stack_id % kKnownStacksSharding;
+    base::AutoLock auto_lock(known_stacks_locks_[known_stack_shard]);
 
-    if (stack->HasNoRefs()) {
-      add_to_reclaimed_list = true;
-      // Remove this from the known stacks as we're going to reclaim it and
-      // overwrite part of its data as we insert into the reclaimed_ list.
-      size_t num_erased = known_stacks_[known_stack_shard].erase(
-          stack_capture->absolute_stack_id());
-      DCHECK_EQ(num_erased, 1u);
+    // Remove this from the known stacks as we're going to reclaim it and
+    // overwrite part of its data as we insert into the reclaimed_ list. This
+    // is skipped if the stack capture has been referenced again since, or if
+    // somebody else already removed it.
+    if (stack_capture->HasNoRefs()) {
+      add_to_reclaimed_list = known_stacks_[known_stack_shard]->Erase(
+          stack_capture, absolute_stack_id);
     }
   }
 
   // Update the statistics.
   if (compression_reporting_period_ != 0) {
     base::AutoLock stats_lock(stats_lock_);
-    DCHECK_LT(0u, statistics_.references);
-    --statistics_.references;
-    statistics_.frames_stored -= stack->num_frames();
+    if (is_referenced) {
+      DCHECK_LT(0u, statistics_.references);
+      --statistics_.references;
+      statistics_.frames_stored -= num_frames;
+    }
     if (add_to_reclaimed_list) {
       --statistics_.cached;
       ++statistics_.unreferenced;
       // The frames in this stack capture are no longer alive.
-      statistics_.frames_alive -= stack->num_frames();
+      statistics_.frames_alive -= num_frame_slots;
     }
   }
 
@@ -298,7 +697,7 @@ void StackCaptureCache::ReleaseStackTrace(
   // must come after the statistics updating, as we modify the |num_frames|
   // parameter in place.
   if (add_to_reclaimed_list)
-    AddStackCaptureToReclaimedList(stack);
+    AddStackCaptureToReclaimedList(stack_capture);
 }
 
 bool StackCaptureCache::StackCapturePointerIsValid(
@@ -323,7 +722,7 @@ bool StackCaptureCache::StackCapturePointerIsValid(
     if (stack_capture_addr >= page->data() &&
         stack_capture_addr + kMinSize <= page_end &&
         stack_capture_addr + stack_capture->Size() <= page_end &&
-        stack_capture->num_frames() <= stack_capture->max_num_frames() &&
+        stack_capture->num_frames() <= common::StackCapture::kMaxNumFrames &&
         stack_capture->max_num_frames() <=
             common::StackCapture::kMaxNumFrames) {
       return true;
@@ -333,6 +732,21 @@ bool StackCaptureCache::StackCapturePointerIsValid(
   return false;
 }
 
+// static
+size_t StackCaptureCache::GetFrames(const common::StackCapture* stack_capture,
+                                    void** frames) {
+  DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
+  DCHECK_NE(static_cast<void**>(nullptr), frames);
+  size_t num_frames = stack_capture->num_frames();
+  if (IsCompact(stack_capture)) {
+    DecodeFrames(reinterpret_cast<const uint8_t*>(stack_capture->frames()),
+                 num_frames, frames);
+  } else if (num_frames != 0) {
+    ::memcpy(frames, stack_capture->frames(), num_frames * sizeof(frames[0]));
+  }
+  return num_frames;
+}
+
 void StackCaptureCache::AddObserver(Observer* obs) {
   observer_list_.AddObserver(obs);
 }
@@ -352,6 +766,14 @@ void StackCaptureCache::LogStatistics()  {
   LogStatisticsImpl(statistics);
 }
 
+void StackCaptureCache::GetHitCounts(uint32_t* requests, uint32_t* hits) const {
+  DCHECK_NE(static_cast<uint32_t*>(nullptr), requests);
+  DCHECK_NE(static_cast<uint32_t*>(nullptr), hits);
+  *requests = static_cast<uint32_t>(
+      base::subtle::NoBarrier_Load(&request_count_));
+  *hits = static_cast<uint32_t>(base::subtle::NoBarrier_Load(&hit_count_));
+}
+
 void StackCaptureCache::AllocateCachePage() {
   static_assert(sizeof(CachePage) % (64 * 1024) == 0,
                 "kCachePageSize should be a multiple of the system allocation "
@@ -385,9 +807,9 @@ void StackCaptureCache::LogStatisticsImpl(const Statistics& statistics) const {
 
   // These are all in bytes.
   double cache_size = statistics.size;
-  double alive_size = statistics.frames_alive * 4;
-  double dead_size = statistics.frames_dead * 4;
-  double stored_size = statistics.frames_stored * 4;
+  double alive_size = statistics.frames_alive * sizeof(void*);
+  double dead_size = statistics.frames_dead * sizeof(void*);
+  double stored_size = statistics.frames_stored * sizeof(void*);
 
   // The |cache_size| is the actual size of storage taken, while |stored_size|
   // is the conceptual amount of frame data that is stored in the cache.
@@ -485,17 +907,6 @@ common::StackCapture* StackCaptureCache::GetStackCapture(size_t num_frames) {
   return stack_capture;
 }
 
-namespace {
-
-class PrivateStackCapture : public common::StackCapture {
- public:
-  // Expose the actual number of frames. We use this to make reclaimed
-  // stack captures look invalid when they're in a free list.
-  using common::StackCapture::num_frames_;
-};
-
-}
-
 void StackCaptureCache::AddStackCaptureToReclaimedList(
     common::StackCapture* stack_capture) {
   DCHECK_NE(static_cast<common::StackCapture*>(nullptr), stack_capture);
@@ -15,8 +15,7 @@
 #ifndef SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 #define SYZYGY_AGENT_ASAN_STACK_CAPTURE_CACHE_H_
 
-#include <unordered_map>
-
+#include "base/atomicops.h"
 #include "base/observer_list.h"
 #include "base/synchronization/lock.h"
 #include "syzygy/agent/asan/shadow.h"
@@ -31,6 +30,11 @@ class AsanLogger;
 class MemoryNotifierInterface;
 
 // A class which manages a thread-safe cache of unique stack traces, by ID.
+//
+// Looking up a stack that is already in the cache is lock-free, which is by far
+// the most common case. Inserting a new stack, or removing one whose last
+// reference has been released, is done under the lock of the shard of the
+// stack.
 class StackCaptureCache {
  public:
   // The size of a page of stack captures, in bytes. This should be in the
@@ -94,6 +98,18 @@ class StackCaptureCache {
     return compression_reporting_period_;
   }
 
+  // @returns true if the frames of newly saved stack traces are stored in
+  //     compact form.
+  bool compact_frames() const { return compact_frames_; }
+
+  // Sets whether the frames of newly saved stack traces are stored in compact
+  // form. This can be changed at any time, as stack captures describe how their
+  // frames are stored.
+  // @param compact_frames True to use compact storage.
+  void set_compact_frames(bool compact_frames) {
+    compact_frames_ = compact_frames;
+  }
+
   // Save (or retrieve) the stack capture into the cache using its
   // absolute_stack_id as the key.
   // @param stack_capture The initialized stack capture to save.
@@ -110,13 +126,40 @@ class StackCaptureCache {
   // safe.
   void LogStatistics();
 
+  // Gets the number of stack traces saved to this cache, and how many of them
+  // were already present in it. Unlike the statistics logged by
+  // LogStatistics these are always collected. This method is thread safe.
+  // @param requests Will receive the number of saved stack traces.
+  // @param hits Will receive the number of saved stack traces that were
+  //     already cached.
+  void GetHitCounts(uint32_t* requests, uint32_t* hits) const;
+
   // Checks if a StackCapture pointer seems to be valid. This only ensure that
   // it point into a CachePage.
   // @param stack_capture The pointer that we want to check.
   // @returns true if the pointer is valid, false otherwise.
   bool StackCapturePointerIsValid(const common::StackCapture* stack_capture);
 
-  // Observer that is notified when a new stack is saved.
+  // Checks if a stack capture saved in a cache stores its frames in compact
+  // form. The frames of such a stack capture are encoded, and must be read
+  // with GetFrames. Its relative stack ID is computed when it is saved.
+  // @param stack_capture The saved stack capture to check.
+  // @returns true if @p stack_capture is stored in compact form.
+  static bool IsCompact(const common::StackCapture* stack_capture) {
+    return stack_capture->num_frames() > stack_capture->max_num_frames();
+  }
+
+  // Copies the frames of a stack capture saved in a cache, decoding them if
+  // they are stored in compact form.
+  // @param stack_capture The saved stack capture to read.
+  // @param frames Will receive the frames. This must be able to hold
+  //     stack_capture->num_frames() frames.
+  // @returns the number of frames copied.
+  static size_t GetFrames(const common::StackCapture* stack_capture,
+                          void** frames);
+
+  // Observer that is notified when a new stack is saved. The new stack may be
+  // in compact form.
   class Observer {
    public:
     virtual void OnNewStack(common::StackCapture* new_stack) = 0;
@@ -132,7 +175,7 @@ class StackCaptureCache {
  protected:
   // The container type in which we store the cached stacks. This enforces
   // uniqueness based on their hash value, nothing more.
-  typedef std::unordered_map<StackId, common::StackCapture*> StackMap;
+  class KnownStacks;
 
   // Used for shuttling around statistics about this cache.
   struct Statistics {
@@ -171,6 +214,8 @@ class StackCaptureCache {
     uint64_t frames_stored;
     // The total number of frames that are physically stored across all active
     // stack captures. This does not double count multiply-referenced captures.
+    // Stack captures in compact form count the number of frame slots used by
+    // their encoded frames.
     uint64_t frames_alive;
     // The total number of frames in unreferenced stack captures. This is used
     // to figure out how much of our cache is actually dead.
@@ -200,6 +245,15 @@ class StackCaptureCache {
   // @param stack_capture The stack capture to be linked into reclaimed_.
   void AddStackCaptureToReclaimedList(common::StackCapture* stack_capture);
 
+  // Releases a reference to a stack capture, and reclaims it if this was the
+  // last one.
+  // @param stack_capture The stack capture to be released.
+  // @param is_referenced Indicates if the released reference was accounted
+  //     for in the statistics. This is false for the references that are
+  //     speculatively taken during lock-free lookups.
+  void ReleaseStackTraceImpl(common::StackCapture* stack_capture,
+                             bool is_referenced);
+
   // The default number of known stacks sets that we keep.
   static const size_t kKnownStacksSharding = 16;
 
@@ -221,8 +275,12 @@ class StackCaptureCache {
   // doesn't really make sense to do so.
   size_t max_num_frames_;
 
-  // The maps of known stacks. Accessed under known_stacks_locks_.
-  StackMap known_stacks_[kKnownStacksSharding];
+  // Indicates if the frames of new stack captures are stored in compact form.
+  bool compact_frames_;
+
+  // The sets of known stacks. These can be searched at any time, but are
+  // modified under known_stacks_locks_.
+  KnownStacks* known_stacks_[kKnownStacksSharding];
 
   // A lock protecting access to current_page_.
   base::Lock current_page_lock_;
@@ -237,6 +295,11 @@ class StackCaptureCache {
   // Aggregate statistics about the cache. Accessed under stats_lock_.
   Statistics statistics_;
 
+  // The always-on hit counters, see GetHitCounts. These are updated with
+  // relaxed atomic increments rather than under stats_lock_.
+  base::subtle::Atomic32 request_count_;
+  base::subtle::Atomic32 hit_count_;
+
   // Locks to protect each reclaimed list from concurrent access.
   base::Lock reclaimed_locks_[common::StackCapture::kMaxNumFrames + 1];
 
@@ -327,6 +390,82 @@ class StackCaptureCache::CachePage {
  private:
   DISALLOW_COPY_AND_ASSIGN(CachePage);
 };
+
+// An open addressing hash table of stack captures, keyed by their absolute
+// stack ID. Find can be called concurrently with any other function, but
+// returns a hint: the stack capture that it returns may have been removed, or
+// may have been reclaimed and reused for another stack, and a stack capture
+// that is present may be missed. All other functions must be called under the
+// lock of the owning shard.
+//
+// The tables are never shrunk. When they need to grow the old table is kept
+// alive until destruction, as lock-free readers may still be probing it.
+class StackCaptureCache::KnownStacks {
+ public:
+  // Constructor.
+  // @param memory_notifier The memory notifier that is informed of the
+  //     memory used by the tables.
+  explicit KnownStacks(MemoryNotifierInterface* memory_notifier);
+
+  // Destructor.
+  ~KnownStacks();
+
+  // Looks up a stack capture.
+  // @param stack_id The absolute ID of the stack to find.
+  // @returns the stack capture that was found, or nullptr.
+  common::StackCapture* Find(StackId stack_id) const;
+
+  // Inserts a stack capture that isn't already present.
+  // @param stack_capture The stack capture to insert.
+  void Insert(common::StackCapture* stack_capture);
+
+  // Removes a stack capture.
+  // @param stack_capture The stack capture to remove.
+  // @param stack_id The absolute ID under which it was inserted.
+  // @returns true if @p stack_capture was found and removed, false otherwise.
+  bool Erase(common::StackCapture* stack_capture, StackId stack_id);
+
+  // @returns the number of stack captures in this set.
+  size_t size() const { return size_; }
+
+  // The number of slots of the initial table.
+  static const size_t kInitialCapacity = 1024;
+
+ protected:
+  struct Table;
+
+  // Allocates and frees tables.
+  Table* AllocateTable(size_t capacity);
+  void FreeTable(Table* table);
+
+  // Grows or cleans up the table so that at least one more stack capture can
+  // be inserted.
+  void Rehash();
+
+  // Inserts a stack capture in the first free slot of its probe sequence,
+  // without checking the load of the table.
+  // @param table The table to insert into.
+  // @param stack_capture The stack capture to insert.
+  // @returns true if an empty slot was used, false if a deleted one was.
+  static bool InsertImpl(Table* table, common::StackCapture* stack_capture);
+
+  // The memory notifier used for the tables.
+  MemoryNotifierInterface* memory_notifier_;
+
+  // The current table. This is only replaced under the lock, but can be read
+  // at any time.
+  Table* volatile table_;
+
+  // The number of stack captures in the table.
+  size_t size_;
+
+  // The number of non-empty slots in the table, including the deleted ones.
+  size_t used_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(KnownStacks);
+};
+
 static_assert(sizeof(StackCaptureCache::CachePage) ==
                   StackCaptureCache::kCachePageSize,
               "kDataSize calculation needs to be updated.");
@@ -15,6 +15,9 @@
 #include "syzygy/agent/asan/stack_capture_cache.h"
 
 #include <memory>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 #include "syzygy/agent/asan/logger.h"
 #include "syzygy/agent/asan/memory_notifiers/null_memory_notifier.h"
@@ -53,6 +56,15 @@ class TestStackCaptureCache : public StackCaptureCache {
 
   CachePage* current_page() { return current_page_; }
 
+  size_t GetKnownStacksCount() {
+    size_t count = 0;
+    for (size_t i = 0; i < kKnownStacksSharding; ++i) {
+      base::AutoLock lock(known_stacks_locks_[i]);
+      count += known_stacks_[i]->size();
+    }
+    return count;
+  }
+
  private:
   using StackCaptureCache::current_page_;
 };
@@ -144,6 +156,28 @@ TEST_F(StackCaptureCacheTest, SaveStackTrace) {
   EXPECT_EQ(capture.num_frames(), s3->max_num_frames());
 }
 
+TEST_F(StackCaptureCacheTest, GetHitCounts) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+
+  uint32_t requests = 0;
+  uint32_t hits = 0;
+  cache.GetHitCounts(&requests, &hits);
+  EXPECT_EQ(0u, requests);
+  EXPECT_EQ(0u, hits);
+
+  StackCapture capture;
+  capture.InitFromStack();
+  const StackCapture* s1 = cache.SaveStackTrace(capture);
+  const StackCapture* s2 = cache.SaveStackTrace(capture);
+  cache.GetHitCounts(&requests, &hits);
+  EXPECT_EQ(2u, requests);
+  EXPECT_EQ(1u, hits);
+
+  cache.ReleaseStackTrace(s1);
+  cache.ReleaseStackTrace(s2);
+}
+
 TEST_F(StackCaptureCacheTest, RestrictedStackTraces) {
   AsanLogger logger;
   TestStackCaptureCache cache(&logger, 20);
@@ -421,6 +455,98 @@ TEST_F(StackCaptureCacheTest, AllocateMultiplePages) {
   EXPECT_NE(page, cache.current_page());
 }
 
+TEST_F(StackCaptureCacheTest, ManyKnownStacks) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+
+  // Use enough stacks for the known stacks tables to have to grow, and to
+  // be cleaned up of their removed stacks.
+  static const size_t kStackCount = 20000;
+  static const size_t kMaxFrames = 8;
+  void* dummy_frames[kMaxFrames] = {};
+  std::vector<const StackCapture*> saved(kStackCount);
+
+  for (size_t round = 0; round < 3; ++round) {
+    for (size_t i = 0; i < kStackCount; ++i) {
+      StackCapture stack;
+      dummy_frames[0] = reinterpret_cast<void*>(round * kStackCount + i);
+      stack.InitFromBuffer(dummy_frames, kMaxFrames);
+      saved[i] = cache.SaveStackTrace(stack);
+      ASSERT_EQ(stack.absolute_stack_id(), saved[i]->absolute_stack_id());
+    }
+    EXPECT_EQ(kStackCount, cache.GetKnownStacksCount());
+
+    // Every stack can be found again.
+    for (size_t i = 0; i < kStackCount; ++i) {
+      StackCapture stack;
+      dummy_frames[0] = reinterpret_cast<void*>(round * kStackCount + i);
+      stack.InitFromBuffer(dummy_frames, kMaxFrames);
+      ASSERT_EQ(saved[i], cache.SaveStackTrace(stack));
+      cache.ReleaseStackTrace(saved[i]);
+    }
+
+    for (size_t i = 0; i < kStackCount; ++i)
+      cache.ReleaseStackTrace(saved[i]);
+    EXPECT_EQ(0u, cache.GetKnownStacksCount());
+  }
+}
+
+namespace {
+
+// Repeatedly saves and releases stacks from a small set, so that lookups race
+// with the removal and reuse of the stack captures.
+class StackCaptureCacheThread : public base::SimpleThread {
+ public:
+  StackCaptureCacheThread(StackCaptureCache* cache, size_t seed)
+      : base::SimpleThread("StackCaptureCacheThread"),
+        cache_(cache),
+        seed_(seed) {
+  }
+
+  void Run() override {
+    void* frames[kFrameCount] = {};
+    for (size_t i = 0; i < kIterationCount; ++i) {
+      StackCapture stack;
+      frames[0] = reinterpret_cast<void*>((seed_ + i) % kStackCount);
+      stack.InitFromBuffer(frames, kFrameCount);
+      const StackCapture* saved = cache_->SaveStackTrace(stack);
+      ASSERT_EQ(stack.absolute_stack_id(), saved->absolute_stack_id());
+      ASSERT_EQ(frames[0], saved->frames()[0]);
+      ASSERT_LT(0u, saved->ref_count());
+      cache_->ReleaseStackTrace(saved);
+    }
+  }
+
+  static const size_t kFrameCount = 4;
+  static const size_t kIterationCount = 100000;
+  static const size_t kStackCount = 8;
+
+ private:
+  StackCaptureCache* cache_;
+  size_t seed_;
+};
+
+}  // namespace
+
+TEST_F(StackCaptureCacheTest, ConcurrentSaveAndRelease) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+
+  static const size_t kThreadCount = 4;
+  std::vector<std::unique_ptr<StackCaptureCacheThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads.push_back(std::unique_ptr<StackCaptureCacheThread>(
+        new StackCaptureCacheThread(&cache, i)));
+  }
+  for (auto& thread : threads)
+    thread->Start();
+  for (auto& thread : threads)
+    thread->Join();
+
+  // All of the references have been released.
+  EXPECT_EQ(0u, cache.GetKnownStacksCount());
+}
+
 TEST_F(StackCaptureCacheTest, EmptyStackCapture) {
   AsanLogger logger;
   TestStackCaptureCache cache(&logger);
@@ -436,5 +562,88 @@ TEST_F(StackCaptureCacheTest, EmptyStackCapture) {
   cache.ReleaseStackTrace(saved_stack2);
 }
 
+TEST_F(StackCaptureCacheTest, CompactFrames) {
+  AsanLogger logger;
+  TestStackCaptureCache cache(&logger);
+  EXPECT_FALSE(cache.compact_frames());
+  cache.set_compact_frames(true);
+  EXPECT_TRUE(cache.compact_frames());
+
+  // Frames that are close to each other, in both directions, and a few that
+  // are far apart.
+  static const size_t kNumFrames = 20;
+  void* frames[kNumFrames] = {};
+  for (size_t i = 0; i < kNumFrames; ++i) {
+    uintptr_t frame = 0x10000000 + ((i * 0x1234) % 0x8000);
+    if (i % 7 == 6)
+      frame = 0x70000000 - i;
+    frames[i] = reinterpret_cast<void*>(frame);
+  }
+
+  StackCapture stack;
+  stack.InitFromBuffer(frames, kNumFrames);
+  const StackCapture* saved = cache.SaveStackTrace(stack);
+  ASSERT_NE(static_cast<const StackCapture*>(nullptr), saved);
+  EXPECT_TRUE(StackCaptureCache::IsCompact(saved));
+  EXPECT_TRUE(cache.StackCapturePointerIsValid(saved));
+  EXPECT_EQ(kNumFrames, saved->num_frames());
+  EXPECT_LT(saved->max_num_frames(), kNumFrames);
+  EXPECT_EQ(stack.absolute_stack_id(), saved->absolute_stack_id());
+  EXPECT_EQ(stack.relative_stack_id(), saved->relative_stack_id());
+
+  void* decoded[StackCapture::kMaxNumFrames] = {};
+  EXPECT_EQ(kNumFrames, StackCaptureCache::GetFrames(saved, decoded));
+  for (size_t i = 0; i < kNumFrames; ++i)
+    EXPECT_EQ(frames[i], decoded[i]);
+
+  // Only the encoded frames are alive.
+  TestStackCaptureCache::Statistics s = {};
+  cache.GetStatistics(&s);
+  EXPECT_EQ(saved->max_num_frames(), s.frames_alive);
+  EXPECT_EQ(kNumFrames, s.frames_stored);
+
+  // The same stack is found again.
+  StackCapture stack2;
+  stack2.InitFromBuffer(frames, kNumFrames);
+  EXPECT_EQ(saved, cache.SaveStackTrace(stack2));
+  cache.ReleaseStackTrace(saved);
+  cache.ReleaseStackTrace(saved);
+  cache.GetStatistics(&s);
+  EXPECT_EQ(0u, s.frames_alive);
+  EXPECT_EQ(0u, s.frames_stored);
+
+  // Frames that don't compress are stored as is.
+  for (size_t i = 0; i < kNumFrames; ++i) {
+    uintptr_t frame = 0x10 + i;
+    if (i % 2 == 0)
+      frame = (~static_cast<uintptr_t>(0) >> 1) - i;
+    frames[i] = reinterpret_cast<void*>(frame);
+  }
+  StackCapture stack3;
+  stack3.InitFromBuffer(frames, kNumFrames);
+  saved = cache.SaveStackTrace(stack3);
+  EXPECT_FALSE(StackCaptureCache::IsCompact(saved));
+  EXPECT_EQ(kNumFrames, StackCaptureCache::GetFrames(saved, decoded));
+  for (size_t i = 0; i < kNumFrames; ++i) {
+    EXPECT_EQ(frames[i], decoded[i]);
+    EXPECT_EQ(frames[i], saved->frames()[i]);
+  }
+  cache.ReleaseStackTrace(saved);
+
+  // Stack captures that are saved before compact storage is disabled can
+  // still be read.
+  StackCapture stack4;
+  stack4.InitFromBuffer(frames + 1, 1);
+  saved = cache.SaveStackTrace(stack);
+  cache.set_compact_frames(false);
+  const StackCapture* saved4 = cache.SaveStackTrace(stack4);
+  EXPECT_TRUE(StackCaptureCache::IsCompact(saved));
+  EXPECT_FALSE(StackCaptureCache::IsCompact(saved4));
+  EXPECT_EQ(kNumFrames, StackCaptureCache::GetFrames(saved, decoded));
+  EXPECT_EQ(reinterpret_cast<void*>(0x10000000), decoded[0]);
+  cache.ReleaseStackTrace(saved);
+  cache.ReleaseStackTrace(saved4);
+}
+
 }  // namespace asan
 }  // namespace agent
@@ -771,6 +771,72 @@ void SyzyAsanMemoryAccessorTester::ExpectSpecialMemoryErrorIsDetected(
   EXPECT_EQ(expect_error, memory_error_detected_);
   check_access_fn = NULL;
 }
+
+namespace {
+
+void CheckRangeAccessAndCaptureContexts(
+    CONTEXT* before, CONTEXT* after, void* location, size_t length) {
+  __asm {
+    pushad
+    pushfd
+
+    // Avoid undefined behavior by forcing values.
+    mov eax, 0x01234567
+    mov ebx, 0x70123456
+    mov ecx, 0x12345678
+    mov edx, 0x56701234
+    mov esi, 0xCCAACCAA
+    mov edi, 0xAACCAACC
+
+    RTL_CAPTURE_CONTEXT(before, check_range_access_expected_eip)
+
+    // Push EDX as we're required to do by the custom calling convention.
+    push edx
+    // Location is the start of the range to check.
+    mov edx, location
+    // Followed by the length of the range.
+    push length
+    // Call through.
+    call dword ptr[check_access_fn + 0]
+ check_range_access_expected_eip:
+
+    RTL_CAPTURE_CONTEXT(after, check_range_access_expected_eip)
+
+    popfd
+    popad
+  }
+}
+
+}  // namespace
+
+void SyzyAsanMemoryAccessorTester::CheckRangeAccessAndCompareContexts(
+    FARPROC access_fn,
+    void* ptr,
+    size_t length) {
+  memory_error_detected_ = false;
+
+  check_access_fn = access_fn;
+
+  CheckRangeAccessAndCaptureContexts(
+      &context_before_hook_, &context_after_hook_, ptr, length);
+
+  ExpectEqualContexts(context_before_hook_, context_after_hook_, ignore_flags_);
+  if (memory_error_detected_) {
+    ExpectEqualContexts(context_before_hook_, error_context_, ignore_flags_);
+  }
+
+  check_access_fn = NULL;
+}
+
+void SyzyAsanMemoryAccessorTester::AssertRangeMemoryErrorIsDetected(
+    FARPROC access_fn,
+    void* ptr,
+    size_t length,
+    BadAccessKind bad_access_type) {
+  expected_error_type_ = bad_access_type;
+  CheckRangeAccessAndCompareContexts(access_fn, ptr, length);
+  ASSERT_TRUE(memory_error_detected_);
+}
 #endif
 
 void ClangMemoryAccessorTester::CheckAccess(FARPROC access_fn, void* ptr) {
@@ -1024,6 +1090,54 @@ void TestMemoryInterceptors::TestStringOverrunAccess(
     }
   }
 }
+
+void TestMemoryInterceptors::TestRangeValidAccess(
+    const RangeInterceptFunction* fns, size_t num_fns) {
+  for (size_t i = 0; i < num_fns; ++i) {
+    const RangeInterceptFunction& fn = fns[i];
+
+    // Check the whole allocation, as well as a range that starts and ends in
+    // the middle of shadow bytes.
+    SyzyAsanMemoryAccessorTester tester;
+    tester.CheckRangeAccessAndCompareContexts(
+        reinterpret_cast<FARPROC>(fn.function), src_, kAllocSize);
+    ASSERT_FALSE(tester.memory_error_detected());
+
+    tester.CheckRangeAccessAndCompareContexts(
+        reinterpret_cast<FARPROC>(fn.function), src_ + 3, 10);
+    ASSERT_FALSE(tester.memory_error_detected());
+  }
+}
+
+void TestMemoryInterceptors::TestRangeOverrunAccess(
+    const RangeInterceptFunction* fns, size_t num_fns) {
+  for (size_t i = 0; i < num_fns; ++i) {
+    const RangeInterceptFunction& fn = fns[i];
+
+    // The range starts in bounds and only its end overruns the allocation.
+    SyzyAsanMemoryAccessorTester tester;
+    tester.AssertRangeMemoryErrorIsDetected(
+        reinterpret_cast<FARPROC>(fn.function), src_ + kAllocSize - 8, 16,
+        MemoryAccessorTester::BadAccessKind::HEAP_BUFFER_OVERFLOW);
+
+    ASSERT_TRUE(tester.memory_error_detected());
+  }
+}
+
+void TestMemoryInterceptors::TestRangeUnderrunAccess(
+    const RangeInterceptFunction* fns, size_t num_fns) {
+  for (size_t i = 0; i < num_fns; ++i) {
+    const RangeInterceptFunction& fn = fns[i];
+
+    // The range ends in bounds and only its start underruns the allocation.
+    SyzyAsanMemoryAccessorTester tester;
+    tester.AssertRangeMemoryErrorIsDetected(
+        reinterpret_cast<FARPROC>(fn.function), src_ - 8, 16,
+        MemoryAccessorTester::BadAccessKind::HEAP_BUFFER_UNDERFLOW);
+
+    ASSERT_TRUE(tester.memory_error_detected());
+  }
+}
 #endif
 
 void TestMemoryInterceptors::TestClangValidAccess(
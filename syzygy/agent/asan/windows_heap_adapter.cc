@@ -15,6 +15,7 @@
 #include "syzygy/agent/asan/windows_heap_adapter.h"
 
 #include <algorithm>
+#include <limits>
 
 #include "base/logging.h"
 #include "syzygy/agent/asan/heap_manager.h"
@@ -82,7 +83,23 @@ LPVOID WINAPI WindowsHeapAdapter::HeapReAlloc(HANDLE heap,
                                               LPVOID mem,
                                               SIZE_T bytes) {
   DCHECK_NE(reinterpret_cast<HeapManagerInterface*>(NULL), heap_manager_);
-  // Always fail in-place reallocation requests.
+
+  // Try to resize the allocation where it is first. This saves a copy, and
+  // keeps the old allocation out of the quarantine.
+  if (mem != NULL && bytes <= std::numeric_limits<uint32_t>::max()) {
+    uint32_t old_size = 0;
+    if ((flags & HEAP_ZERO_MEMORY) != 0)
+      old_size = heap_manager_->Size(HandleToHeapId(heap), mem);
+    if (heap_manager_->ResizeInPlace(HandleToHeapId(heap), mem,
+                                     static_cast<uint32_t>(bytes))) {
+      if (bytes > old_size && (flags & HEAP_ZERO_MEMORY) != 0)
+        ::memset(static_cast<uint8_t*>(mem) + old_size, 0, bytes - old_size);
+      return mem;
+    }
+  }
+
+  // In-place reallocation requests fail if the allocation can't be resized
+  // where it is.
   if ((flags & HEAP_REALLOC_IN_PLACE_ONLY) != 0)
     return NULL;
 
@@ -42,6 +42,18 @@
 //                                    call [leave_hook]
 //                                    jz BB2
 //
+//    Inlined fast path for basic block entry count:
+//      BB1: [code]       --->   BB1: push bb_id
+//           call func                call fast_path
+//           jz BB2                   [code]
+//                                    call func
+//                                    jz BB2
+//
+//    The fast path is a thunk injected in the instrumented module. It
+//    increments a per-thread byte counter, found through an implicit TLS
+//    slot, and only calls the increment_hook the first time a thread runs
+//    instrumented code, or when a counter wraps around.
+//
 //    Using the last block id produced by an entry_hook to determine the
 //    previous executed basic block won't work. As an example, the call to
 //    'func' will move the control flow to another function and modify the last
@@ -65,6 +77,11 @@
 //      mode, under a non-standard execution (crash, force exit, ...) pending
 //      events may be lost.
 //
+//    Both the branch entry events and the indexed frequency increments (used
+//    by the basic block entry and jump table counts) may be buffered. The
+//    buffered increments are sorted on commit, so that each counter is only
+//    updated once per distinct index in the buffer.
+//
 //    The agent keeps a ThreadState for each running thread. The thread state
 //    is accessible through a TLS mechanism and contains information needed by
 //    the hook (pointer to trace segment, buffer, lock, ...).
@@ -78,11 +95,19 @@
 //      See: http://en.wikipedia.org/wiki/Win32_Thread_Information_Block.
 //      There is no API to check whether another module is using this slot, thus
 //      this mechanism must be used in a controlled environment.
+//
+//    With the inlined fast path, the thread state also owns the per-thread
+//    counters. Their address is published in the implicit TLS slot of the
+//    module, and they are merged into the process-wide segment when the thread
+//    detaches.
 
 #include "syzygy/agent/basic_block_entry/basic_block_entry.h"
+
+#include <algorithm>
 #include <memory>
 
 #include "base/at_exit.h"
+#include "base/bind.h"
 #include "base/command_line.h"
 #include "base/environment.h"
 #include "base/lazy_instance.h"
@@ -167,6 +192,9 @@ BBPROBE_REDIRECT_CALL(_branch_exit, BranchExitHook, 8)
 BBPROBE_REDIRECT_CALL(_increment_indexed_freq_data,
                       IncrementIndexedFreqDataHook,
                       8)
+BBPROBE_REDIRECT_CALL(_increment_indexed_freq_data_buffered,
+                      IncrementIndexedFreqDataBufferedHook,
+                      8)
 
 // This is expected to be called via instrumentation that looks like:
 //    push module_data
@@ -260,6 +288,7 @@ namespace basic_block_entry {
 namespace {
 
 using ::common::IndexedFrequencyData;
+using ::common::ThreadLocalIndexedFrequencyData;
 using agent::common::ScopedLastErrorKeeper;
 using trace::client::TraceFileSegment;
 
@@ -267,6 +296,10 @@ const uint32_t kUserApplicationSlot = 0x700;
 const uint32_t kNumSlots = 4U;
 const uint32_t kInvalidBasicBlockId = ~0U;
 
+// 0:000> dt ntdll!_TEB ThreadLocalStoragePointer
+//   +0x02c ThreadLocalStoragePointer : Ptr32 Void
+const uint32_t kOffsetTebStorage = 0x2C;
+
 // The indexed_frequency_data for the bbentry instrumentation mode has 1 column.
 struct BBEntryFrequency {
   uint32_t frequency;
@@ -296,6 +329,32 @@ inline uint32_t IncrementAndSaturate(uint32_t value) {
   return value;
 }
 
+// Add to and saturate a 32-bit value.
+inline uint32_t AddAndSaturate(uint32_t value, uint32_t addend) {
+  if (value > ~0U - addend)
+    return ~0U;
+  return value + addend;
+}
+
+// Get the size of the frequency data record @p data, including its counters.
+size_t GetRecordSize(const TraceIndexedFrequencyData& data) {
+  return sizeof(TraceIndexedFrequencyData) +
+      data.num_entries * data.frequency_size * data.num_columns - 1;
+}
+
+// Get the implicit TLS slot holding the inline counters of the current thread
+// for the module described by @p module_data.
+uint8_t** GetInlineCountersSlot(
+    const ThreadLocalIndexedFrequencyData* module_data) {
+  DCHECK(module_data != NULL);
+  DCHECK_NE(0U, module_data->inline_counter_size);
+  uint8_t** tls_blocks =
+      reinterpret_cast<uint8_t**>(__readfsdword(kOffsetTebStorage));
+  uint8_t* tls_block = tls_blocks[module_data->inline_tls_index];
+  return reinterpret_cast<uint8_t**>(tls_block +
+                                     module_data->inline_tls_offset);
+}
+
 // Get the address of the module containing @p addr. We do this by querying
 // for the allocation that contains @p addr. This must lie within the
 // instrumented module, and be part of the single allocation in which the
@@ -404,14 +463,46 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   // Allocate space to buffer basic block ids.
   void AllocateBasicBlockIdBuffer();
 
+  // Allocate space to buffer frequency increments.
+  void AllocateCountBuffer();
+
   // Allocate temporary space to simulate a branch predictor.
   void AllocatePredictorCache();
 
+  // Allocate the counters incremented by the inlined fast path, and publish
+  // them in the implicit TLS slot of the current thread.
+  void AllocateInlineCounters();
+
+  // Clear the implicit TLS slot of the current thread, so that the inlined
+  // fast path stops using the inline counters.
+  void UnpublishInlineCounters();
+
   // Saturation increment the frequency record for @p index. Note that in
   // Release mode, no range checking is performed on index.
   // @param basic_block_id the basic block index.
   void Increment(uint32_t basic_block_id);
 
+  // Increment the inline counter for @p basic_block_id on behalf of the
+  // inlined fast path, folding it into the frequency record if it wraps
+  // around. Falls back to Increment if there are no inline counters.
+  // @param basic_block_id the basic block index.
+  void IncrementInline(uint32_t basic_block_id);
+
+  // Merge the inline counters into the frequency records, and reset them.
+  void MergeInlineCounters();
+
+  // @returns true if frequency increments can be buffered.
+  bool has_count_buffer() const { return !count_buffer_.empty(); }
+
+  // Push a frequency increment in the count buffer, to be committed later.
+  // @param basic_block_id the basic block index.
+  // @returns true when the buffer is full and there is no room for an other
+  //     entry, false otherwise.
+  bool PushCount(uint32_t basic_block_id);
+
+  // Commit pending increments in the count buffer to the frequency records.
+  void FlushCounts();
+
   // Update state and frequency when a jump enters the basic block @p index
   // coming from the basic block @last.
   // @param basic_block_id the basic block index.
@@ -478,12 +569,25 @@ class BasicBlockEntry::ThreadState : public agent::common::ThreadStateBase {
   // Current offset of the next available entry in the basic block id buffer.
   uint32_t basic_block_id_buffer_offset_;
 
+  // Buffer used to queue frequency increments for later processing in batches.
+  std::vector<uint32_t> count_buffer_;
+
+  // Current offset of the next available entry in the count buffer.
+  uint32_t count_buffer_offset_;
+
   // The branch predictor state (2-bit saturating counter).
   std::vector<uint8_t> predictor_data_;
 
   // The last basic block id executed.
   uint32_t last_basic_block_id_;
 
+  // The per-thread counters incremented by the inlined fast path.
+  std::vector<uint8_t> inline_counters_;
+
+  // The implicit TLS slot where inline_counters_ is published. This is only
+  // valid while the owning thread is alive.
+  uint8_t** inline_counters_slot_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(ThreadState);
 };
@@ -495,13 +599,21 @@ BasicBlockEntry::ThreadState::ThreadState(IndexedFrequencyData* module_data,
       module_data_(module_data),
       trace_lock_(lock),
       basic_block_id_buffer_offset_(0),
-      last_basic_block_id_(kInvalidBasicBlockId) {
+      count_buffer_offset_(0),
+      last_basic_block_id_(kInvalidBasicBlockId),
+      inline_counters_slot_(NULL) {
 }
 
 BasicBlockEntry::ThreadState::~ThreadState() {
   if (!basic_block_id_buffer_.empty())
     Flush();
 
+  if (!count_buffer_.empty())
+    FlushCounts();
+
+  if (!inline_counters_.empty())
+    MergeInlineCounters();
+
   uint32_t slot = GetBasicBlockData()->fs_slot;
   if (slot != 0) {
     uint32_t address = kUserApplicationSlot + 4 * (slot - 1);
@@ -514,11 +626,34 @@ void BasicBlockEntry::ThreadState::AllocateBasicBlockIdBuffer() {
   basic_block_id_buffer_.resize(kBufferSize * sizeof(BranchBufferEntry));
 }
 
+void BasicBlockEntry::ThreadState::AllocateCountBuffer() {
+  DCHECK(count_buffer_.empty());
+  count_buffer_.resize(kBufferSize);
+}
+
 void BasicBlockEntry::ThreadState::AllocatePredictorCache() {
   DCHECK(predictor_data_.empty());
   predictor_data_.resize(kPredictorCacheSize);
 }
 
+void BasicBlockEntry::ThreadState::AllocateInlineCounters() {
+  DCHECK(inline_counters_.empty());
+  DCHECK(inline_counters_slot_ == NULL);
+  DCHECK_EQ(sizeof(uint8_t), GetBasicBlockData()->inline_counter_size);
+
+  inline_counters_.resize(module_data_->num_entries);
+  inline_counters_slot_ = GetInlineCountersSlot(GetBasicBlockData());
+  *inline_counters_slot_ = inline_counters_.data();
+}
+
+void BasicBlockEntry::ThreadState::UnpublishInlineCounters() {
+  if (inline_counters_slot_ == NULL)
+    return;
+  DCHECK_EQ(inline_counters_.data(), *inline_counters_slot_);
+  *inline_counters_slot_ = NULL;
+  inline_counters_slot_ = NULL;
+}
+
 void BasicBlockEntry::ThreadState::reset_last_basic_block_id() {
   last_basic_block_id_ = kInvalidBasicBlockId;
 }
@@ -551,6 +686,38 @@ inline void BasicBlockEntry::ThreadState::Increment(uint32_t basic_block_id) {
   entry.frequency = IncrementAndSaturate(entry.frequency);
 }
 
+void BasicBlockEntry::ThreadState::IncrementInline(uint32_t basic_block_id) {
+  DCHECK(module_data_ != NULL);
+  DCHECK_LT(basic_block_id, module_data_->num_entries);
+
+  if (inline_counters_.empty()) {
+    Increment(basic_block_id);
+    return;
+  }
+
+  // The fast path hands over the events that would wrap a counter around.
+  uint8_t& counter = inline_counters_[basic_block_id];
+  if (++counter != 0)
+    return;
+
+  BBEntryFrequency& entry = GetBBEntryFrequency(basic_block_id);
+  entry.frequency = AddAndSaturate(entry.frequency, 1U << 8);
+}
+
+void BasicBlockEntry::ThreadState::MergeInlineCounters() {
+  DCHECK(frequency_data_ != NULL);
+  DCHECK(inline_counters_.empty() ||
+         inline_counters_.size() == module_data_->num_entries);
+
+  for (size_t i = 0; i < inline_counters_.size(); ++i) {
+    if (inline_counters_[i] == 0)
+      continue;
+    BBEntryFrequency& entry = GetBBEntryFrequency(i);
+    entry.frequency = AddAndSaturate(entry.frequency, inline_counters_[i]);
+    inline_counters_[i] = 0;
+  }
+}
+
 void BasicBlockEntry::ThreadState::Enter(uint32_t basic_block_id,
                                          uint32_t last_basic_block_id) {
   DCHECK(frequency_data_ != NULL);
@@ -640,6 +807,40 @@ void BasicBlockEntry::ThreadState::Flush() {
   basic_block_id_buffer_offset_ = 0;
 }
 
+bool BasicBlockEntry::ThreadState::PushCount(uint32_t basic_block_id) {
+  DCHECK(module_data_ != NULL);
+  DCHECK_LT(basic_block_id, module_data_->num_entries);
+  DCHECK_LT(count_buffer_offset_, count_buffer_.size());
+
+  count_buffer_[count_buffer_offset_] = basic_block_id;
+  ++count_buffer_offset_;
+
+  return count_buffer_offset_ == count_buffer_.size();
+}
+
+void BasicBlockEntry::ThreadState::FlushCounts() {
+  DCHECK(frequency_data_ != NULL);
+  uint32_t last_offset = count_buffer_offset_;
+
+  // Group the increments of each basic block, and commit each group with a
+  // single saturating addition.
+  std::vector<uint32_t>::iterator begin = count_buffer_.begin();
+  std::vector<uint32_t>::iterator end = begin + last_offset;
+  std::sort(begin, end);
+  while (begin != end) {
+    uint32_t basic_block_id = *begin;
+    std::vector<uint32_t>::iterator next =
+        std::upper_bound(begin, end, basic_block_id);
+    BBEntryFrequency& entry = GetBBEntryFrequency(basic_block_id);
+    entry.frequency = AddAndSaturate(entry.frequency,
+                                     static_cast<uint32_t>(next - begin));
+    begin = next;
+  }
+
+  // Reset buffer.
+  count_buffer_offset_ = 0;
+}
+
 BasicBlockEntry* BasicBlockEntry::Instance() {
   return static_bbentry_instance.Pointer();
 }
@@ -647,9 +848,19 @@ BasicBlockEntry* BasicBlockEntry::Instance() {
 BasicBlockEntry::BasicBlockEntry() : registered_slots_() {
   // Create a session.
   trace::client::InitializeRpcSession(&session_, &segment_);
+
+  // Snapshots are shipped through the session, so there's no point in taking
+  // any without one.
+  if (!session_.IsDisabled() &&
+      !snapshot_trigger_.StartFromEnvironment(base::Bind(
+          &BasicBlockEntry::TakeSnapshot, base::Unretained(this)))) {
+    LOG(ERROR) << "Failed to start the frequency data snapshots.";
+  }
 }
 
 BasicBlockEntry::~BasicBlockEntry() {
+  // Wait for a snapshot in progress to complete while the session is alive.
+  snapshot_trigger_.Stop();
 }
 
 bool BasicBlockEntry::InitializeFrequencyData(IndexedFrequencyData* data) {
@@ -714,9 +925,63 @@ bool BasicBlockEntry::InitializeFrequencyData(IndexedFrequencyData* data) {
   data->frequency_data =
       reinterpret_cast<uint32_t*>(&trace_data->frequency_data[0]);
 
+  // Make the record available to the snapshots.
+  {
+    base::AutoLock scoped_lock(lock_);
+    trace_data_.push_back(trace_data);
+  }
+
   return true;
 }
 
+void BasicBlockEntry::TakeSnapshot() {
+  // Size the snapshot up front, so that the buffer isn't allocated under the
+  // lock. Records are never removed, so the ones seen here are still there
+  // when they are copied.
+  size_t num_records = 0;
+  size_t segment_size = 0;
+  {
+    base::AutoLock scoped_lock(lock_);
+    num_records = trace_data_.size();
+    for (const TraceIndexedFrequencyData* trace_data : trace_data_)
+      segment_size += sizeof(RecordPrefix) + GetRecordSize(*trace_data);
+  }
+  if (num_records == 0)
+    return;
+
+  TraceFileSegment snapshot_segment;
+  if (!session_.AllocateBuffer(segment_size, &snapshot_segment)) {
+    LOG(ERROR) << "Failed to allocate frequency data snapshot segment.";
+    return;
+  }
+
+  // All the counters are committed under the lock, so holding it while the
+  // records are copied and reset gives a consistent snapshot, and no commits
+  // are lost. The counters then only hold the counts since this snapshot, so
+  // the records of a module add up to its total counts.
+  {
+    base::AutoLock scoped_lock(lock_);
+    for (size_t i = 0; i < num_records; ++i) {
+      TraceIndexedFrequencyData* trace_data = trace_data_[i];
+      size_t record_size = GetRecordSize(*trace_data);
+      if (!snapshot_segment.CanAllocate(record_size)) {
+        LOG(ERROR) << "Frequency data snapshot segment smaller than expected.";
+        break;
+      }
+      void* snapshot = snapshot_segment.AllocateTraceRecordImpl(
+          TRACE_INDEXED_FREQUENCY, record_size);
+      DCHECK(snapshot != NULL);
+      ::memcpy(snapshot, trace_data, record_size);
+      ::memset(trace_data->frequency_data, 0,
+               record_size - offsetof(TraceIndexedFrequencyData,
+                                      frequency_data));
+    }
+  }
+
+  if (!session_.ReturnBuffer(&snapshot_segment))
+    LOG(ERROR) << "Failed to return frequency data snapshot segment.";
+}
+
 BasicBlockEntry::ThreadState* BasicBlockEntry::CreateThreadState(
     IndexedFrequencyData* module_data) {
   DCHECK(module_data != NULL);
@@ -763,6 +1028,16 @@ BasicBlockEntry::ThreadState* BasicBlockEntry::CreateThreadState(
   if (module_data->data_type == ::common::IndexedFrequencyData::BRANCH)
     state->AllocatePredictorCache();
 
+  // Allocate the buffer used by buffered frequency increments.
+  if (module_data->data_type != ::common::IndexedFrequencyData::BRANCH &&
+      basicblock_data->inline_counter_size == 0) {
+    state->AllocateCountBuffer();
+  }
+
+  // Allocate the counters used by the inlined fast path.
+  if (basicblock_data->inline_counter_size != 0)
+    state->AllocateInlineCounters();
+
   // Allocate buffer to which basic block id are pushed before being committed.
   state->AllocateBasicBlockIdBuffer();
 
@@ -805,7 +1080,37 @@ void WINAPI BasicBlockEntry::IncrementIndexedFreqDataHook(
   }
 
   base::AutoLock scoped_lock(*state->trace_lock());
-  state->Increment(entry_frame->index);
+  if (state->GetBasicBlockData()->inline_counter_size != 0) {
+    state->IncrementInline(entry_frame->index);
+  } else {
+    state->Increment(entry_frame->index);
+  }
+}
+
+void WINAPI BasicBlockEntry::IncrementIndexedFreqDataBufferedHook(
+    IncrementIndexedFreqDataFrame* entry_frame) {
+  DCHECK(entry_frame != NULL);
+  DCHECK(entry_frame->module_data != NULL);
+  DCHECK_GT(entry_frame->module_data->num_entries,
+            entry_frame->index);
+
+  ThreadState* state = GetThreadState(entry_frame->module_data);
+  if (state == NULL) {
+    ScopedLastErrorKeeper scoped_last_error_keeper;
+    state = Instance()->CreateThreadState(entry_frame->module_data);
+  }
+
+  // Without a buffer (i.e., when not tracing), commit the increment directly.
+  if (!state->has_count_buffer()) {
+    base::AutoLock scoped_lock(*state->trace_lock());
+    state->Increment(entry_frame->index);
+    return;
+  }
+
+  if (state->PushCount(entry_frame->index)) {
+    base::AutoLock scoped_lock(*state->trace_lock());
+    state->FlushCounts();
+  }
 }
 
 void WINAPI BasicBlockEntry::BranchEnterHook(
@@ -1051,6 +1356,20 @@ void BasicBlockEntry::OnThreadDetach(IndexedFrequencyData* module_data) {
     return;
 
   state->Flush();
+
+  if (state->has_count_buffer()) {
+    base::AutoLock scoped_lock(*state->trace_lock());
+    state->FlushCounts();
+  }
+
+  // The implicit TLS slot is released along with the thread, so this is the
+  // last chance to stop the fast path from using the inline counters.
+  if (basicblock_data->inline_counter_size != 0) {
+    state->UnpublishInlineCounters();
+    base::AutoLock scoped_lock(*state->trace_lock());
+    state->MergeInlineCounters();
+  }
+
   thread_state_manager_.MarkForDeath(state);
 }
 
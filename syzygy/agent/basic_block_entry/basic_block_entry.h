@@ -20,6 +20,13 @@
 // The instrumenter can be used to inject a run-time dependency on this
 // library as well as to add the appropriate entry-hook code.
 // For details on the implementation, see basic_block_entry.cc.
+//
+// Long-running processes can have snapshots of their counters shipped to the
+// trace file while they run, by setting the environment variables declared in
+// syzygy/common/indexed_frequency_data.h. Each snapshot holds the counts
+// committed since the previous one, so the records of a module add up to its
+// total counts. Counts still buffered by a thread are part of a later
+// snapshot, or of the final record.
 
 #ifndef SYZYGY_AGENT_BASIC_BLOCK_ENTRY_BASIC_BLOCK_ENTRY_H_
 #define SYZYGY_AGENT_BASIC_BLOCK_ENTRY_BASIC_BLOCK_ENTRY_H_
@@ -30,9 +37,11 @@
 
 #include "base/lazy_instance.h"
 #include "base/win/pe_image.h"
+#include "syzygy/agent/common/snapshot_trigger.h"
 #include "syzygy/agent/common/thread_state.h"
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/trace/client/rpc_session.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
 
 namespace agent {
 namespace basic_block_entry {
@@ -77,6 +86,10 @@ class BasicBlockEntry {
   static void WINAPI IncrementIndexedFreqDataHook(
       IncrementIndexedFreqDataFrame* entry_frame);
 
+  // Called from _increment_indexed_freq_data_buffered.
+  static void WINAPI IncrementIndexedFreqDataBufferedHook(
+      IncrementIndexedFreqDataFrame* entry_frame);
+
   // Called from _branch_enter.
   static void WINAPI BranchEnterHook(
       IncrementIndexedFreqDataFrame* entry_frame);
@@ -127,6 +140,11 @@ class BasicBlockEntry {
   // Initializes the given frequency data element.
   bool InitializeFrequencyData(IndexedFrequencyData* data);
 
+  // Ships a copy of the frequency data of the initialized modules to the
+  // call-trace service, and resets their counters. The instrumented threads
+  // are only held up while the counters are copied.
+  void TakeSnapshot();
+
   // Handles EXE startup on ExeMainEntryHook and DLL_PROCESS_ATTACH messages
   // received by DllMainEntryHook().
   void OnProcessAttach(IndexedFrequencyData* module_data);
@@ -176,6 +194,13 @@ class BasicBlockEntry {
 
   // Global lock to avoid concurrent segment_ update.
   base::Lock lock_;
+
+  // The frequency data records of the initialized modules, in the order they
+  // were initialized. Under lock_.
+  std::vector<TraceIndexedFrequencyData*> trace_data_;
+
+  // Triggers the snapshots of the frequency data, if they were asked for.
+  agent::common::SnapshotTrigger snapshot_trigger_;
 };
 
 }  // namespace basic_block_entry
@@ -16,8 +16,11 @@
 
 #include "syzygy/agent/basic_block_entry/basic_block_entry.h"
 
+#include <memory>
+
 #include "base/bind.h"
 #include "base/callback.h"
+#include "base/environment.h"
 #include "base/files/file_enumerator.h"
 #include "base/files/file_util.h"
 #include "base/files/scoped_temp_dir.h"
@@ -41,6 +44,8 @@ namespace {
 
 using ::common::IndexedFrequencyData;
 using testing::_;
+using testing::AtLeast;
+using testing::Invoke;
 using testing::StrictMockParseEventHandler;
 using trace::parser::Parser;
 
@@ -87,6 +92,7 @@ class BasicBlockEntryTest : public testing::Test {
  public:
   enum InstrumentationMode {
     kBasicBlockEntryInstrumentation,
+    kBufferedBasicBlockEntryInstrumentation,
     kBranchInstrumentation,
     kBufferedBranchInstrumentation,
     kBranchWithSlotInstrumentation,
@@ -100,6 +106,8 @@ class BasicBlockEntryTest : public testing::Test {
 
   BasicBlockEntryTest()
       : agent_module_(NULL) {
+    ::memset(accumulated_frequency_data_, 0,
+             sizeof(accumulated_frequency_data_));
   }
 
   void ConfigureBasicBlockAgent() {
@@ -108,6 +116,7 @@ class BasicBlockEntryTest : public testing::Test {
     common_data_->version = ::common::kBasicBlockFrequencyDataVersion;
     module_data_.tls_index = TLS_OUT_OF_INDEXES;
     module_data_.fs_slot = 0;
+    module_data_.inline_counter_size = 0;
     common_data_->initialization_attempted = 0U;
     common_data_->num_entries = kNumBasicBlocks;
     common_data_->num_columns = kNumColumns;
@@ -122,6 +131,7 @@ class BasicBlockEntryTest : public testing::Test {
     common_data_->version = ::common::kBasicBlockFrequencyDataVersion;
     module_data_.tls_index = TLS_OUT_OF_INDEXES;
     module_data_.fs_slot = 0;
+    module_data_.inline_counter_size = 0;
     common_data_->initialization_attempted = 0U;
     common_data_->num_entries = kNumBasicBlocks;
     common_data_->num_columns = kNumBranchColumns;
@@ -133,6 +143,7 @@ class BasicBlockEntryTest : public testing::Test {
   void ConfigureAgent(InstrumentationMode mode) {
     switch (mode) {
       case kBasicBlockEntryInstrumentation:
+      case kBufferedBasicBlockEntryInstrumentation:
         ConfigureBasicBlockAgent();
         break;
       case kBranchInstrumentation:
@@ -190,6 +201,9 @@ class BasicBlockEntryTest : public testing::Test {
   virtual void TearDown() override {
     UnloadDll();
     service_.Stop();
+
+    std::unique_ptr<base::Environment> env(base::Environment::Create());
+    env->UnSetVar(::common::kIndexedFrequencySnapshotIntervalEnvVar);
   }
 
   void StartService() {
@@ -266,6 +280,10 @@ class BasicBlockEntryTest : public testing::Test {
         ::GetProcAddress(agent_module_, "_increment_indexed_freq_data");
     ASSERT_TRUE(basic_block_increment_stub_ != NULL);
 
+    basic_block_increment_buffered_stub_ = ::GetProcAddress(
+        agent_module_, "_increment_indexed_freq_data_buffered");
+    ASSERT_TRUE(basic_block_increment_buffered_stub_ != NULL);
+
     indirect_penter_dllmain_stub_ =
         ::GetProcAddress(agent_module_, "_indirect_penter_dllmain");
     ASSERT_TRUE(indirect_penter_dllmain_stub_ != NULL);
@@ -287,6 +305,7 @@ class BasicBlockEntryTest : public testing::Test {
       basic_block_exit_s1_stub_ = NULL;
       basic_block_function_enter_s1_stub_ = NULL;
       basic_block_increment_stub_ = NULL;
+      basic_block_increment_buffered_stub_ = NULL;
       indirect_penter_dllmain_stub_ = NULL;
       indirect_penter_exemain_stub_ = NULL;
     }
@@ -312,6 +331,14 @@ class BasicBlockEntryTest : public testing::Test {
     }
   }
 
+  void SimulateBasicBlockEntryBuffered(uint32_t basic_block_id) {
+    __asm {
+      push basic_block_id
+      push offset module_data_
+      call basic_block_increment_buffered_stub_
+    }
+  }
+
   void SimulateBranchEnter(uint32_t basic_block_id) {
     __asm {
       push basic_block_id
@@ -378,6 +405,9 @@ class BasicBlockEntryTest : public testing::Test {
       case kBasicBlockEntryInstrumentation:
         SimulateBasicBlockEntry(basic_block_id);
         break;
+      case kBufferedBasicBlockEntryInstrumentation:
+        SimulateBasicBlockEntryBuffered(basic_block_id);
+        break;
       case kBranchInstrumentation:
         SimulateBranchEnter(basic_block_id);
         SimulateBranchExit(basic_block_id);
@@ -510,6 +540,23 @@ class BasicBlockEntryTest : public testing::Test {
     ASSERT_NO_FATAL_FAILURE(StopService());
   }
 
+  // Adds the frequency data of a record to accumulated_frequency_data_.
+  void AccumulateFrequencyData(base::Time time,
+                               DWORD process_id,
+                               DWORD thread_id,
+                               const TraceIndexedFrequencyData* data) {
+    ASSERT_EQ(sizeof(uint32_t), data->frequency_size);
+    ASSERT_EQ(kNumBasicBlocks, data->num_entries);
+    ASSERT_EQ(kNumColumns, data->num_columns);
+    const uint32_t* frequencies =
+        reinterpret_cast<const uint32_t*>(data->frequency_data);
+    for (size_t i = 0; i < kNumBasicBlocks; ++i)
+      accumulated_frequency_data_[i] += frequencies[i];
+  }
+
+  // The sum of the frequency data records seen by AccumulateFrequencyData.
+  uint32_t accumulated_frequency_data_[kNumBasicBlocks];
+
   // The directory where trace file output will be written.
   base::ScopedTempDir temp_dir_;
 
@@ -556,6 +603,9 @@ class BasicBlockEntryTest : public testing::Test {
   // The basic-block increment hook.
   static FARPROC basic_block_increment_stub_;
 
+  // The basic-block increment hook (with buffering).
+  static FARPROC basic_block_increment_buffered_stub_;
+
   // The DllMain entry stub.
   static FARPROC indirect_penter_dllmain_stub_;
 
@@ -602,6 +652,7 @@ FARPROC BasicBlockEntryTest::basic_block_exit_stub_ = NULL;
 FARPROC BasicBlockEntryTest::basic_block_exit_s1_stub_ = NULL;
 FARPROC BasicBlockEntryTest::basic_block_function_enter_s1_stub_ = NULL;
 FARPROC BasicBlockEntryTest::basic_block_increment_stub_ = NULL;
+FARPROC BasicBlockEntryTest::basic_block_increment_buffered_stub_ = NULL;
 FARPROC BasicBlockEntryTest::indirect_penter_dllmain_stub_ = NULL;
 FARPROC BasicBlockEntryTest::indirect_penter_exemain_stub_ = NULL;
 
@@ -783,6 +834,63 @@ TEST_F(BasicBlockEntryTest, SingleThreadedExeBasicBlockEvents) {
   ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
 }
 
+TEST_F(BasicBlockEntryTest, SnapshotsAddUpToTotalCounts) {
+  // Ask for snapshots as often as possible.
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_TRUE(env->SetVar(::common::kIndexedFrequencySnapshotIntervalEnvVar,
+                          "1"));
+
+  // Configure for BasicBlock mode.
+  ConfigureBasicBlockAgent();
+
+  ASSERT_NO_FATAL_FAILURE(StartService());
+  ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+  // Simulate the process attach event.
+  SimulateModuleEvent(DLL_PROCESS_ATTACH);
+
+  // Give the snapshots a chance to be taken in between the visits.
+  const uint32_t kNumIterations = 100;
+  for (uint32_t i = 0; i < kNumIterations; ++i) {
+    SimulateBasicBlockEntry(0);
+    SimulateBasicBlockEntry(0);
+    SimulateBasicBlockEntry(1);
+    if (i % 10 == 0)
+      ::Sleep(5);
+  }
+
+  // Simulate the process detach event.
+  SimulateModuleEvent(DLL_PROCESS_DETACH);
+
+  // Unload the DLL and stop the service.
+  ASSERT_NO_FATAL_FAILURE(UnloadDll());
+
+  HMODULE self = ::GetModuleHandle(NULL);
+  DWORD process_id = ::GetCurrentProcessId();
+  DWORD thread_id = ::GetCurrentThreadId();
+
+  // Set up expectations for what should be in the trace. The snapshots are
+  // shipped from other threads.
+  EXPECT_CALL(handler_, OnProcessStarted(_, process_id, _));
+  EXPECT_CALL(handler_, OnProcessAttach(_,
+                                        process_id,
+                                        thread_id,
+                                        ModuleAtAddress(self)));
+  EXPECT_CALL(handler_, OnIndexedFrequency(_, process_id, _,
+                                           ModuleAtAddress(self)))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Invoke(this,
+                             &BasicBlockEntryTest::AccumulateFrequencyData));
+  EXPECT_CALL(handler_, OnProcessEnded(_, process_id));
+
+  // Replay the log.
+  ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
+
+  // However the counts were split across the records, they add up.
+  EXPECT_EQ(2 * kNumIterations, accumulated_frequency_data_[0]);
+  EXPECT_EQ(kNumIterations, accumulated_frequency_data_[1]);
+}
+
 TEST_F(BasicBlockEntryTest, SingleThreadedExeBranchEvents) {
   // Configure for Branch mode.
   ConfigureBranchAgent();
@@ -916,6 +1024,16 @@ TEST_F(BasicBlockEntryTest, BranchWithBufferingEvents) {
   ASSERT_NO_FATAL_FAILURE(StopService());
 }
 
+TEST_F(BasicBlockEntryTest, SingleExeBufferedBasicBlockEvents) {
+  ASSERT_NO_FATAL_FAILURE(
+    CheckExecution(kExeMain, kBufferedBasicBlockEntryInstrumentation));
+}
+
+TEST_F(BasicBlockEntryTest, SingleDllBufferedBasicBlockEvents) {
+  ASSERT_NO_FATAL_FAILURE(
+    CheckExecution(kDllMain, kBufferedBasicBlockEntryInstrumentation));
+}
+
 TEST_F(BasicBlockEntryTest, SingleExeBranchEvents) {
   ASSERT_NO_FATAL_FAILURE(
     CheckExecution(kExeMain, kBranchInstrumentation));
@@ -966,6 +1084,16 @@ TEST_F(BasicBlockEntryTest, MultiThreadedExeBasicBlockEvents) {
       CheckThreadExecution(kExeMain, kBasicBlockEntryInstrumentation));
 }
 
+TEST_F(BasicBlockEntryTest, MultiThreadedDllBufferedBasicBlockEvents) {
+  ASSERT_NO_FATAL_FAILURE(
+      CheckThreadExecution(kDllMain, kBufferedBasicBlockEntryInstrumentation));
+}
+
+TEST_F(BasicBlockEntryTest, MultiThreadedExeBufferedBasicBlockEvents) {
+  ASSERT_NO_FATAL_FAILURE(
+      CheckThreadExecution(kExeMain, kBufferedBasicBlockEntryInstrumentation));
+}
+
 TEST_F(BasicBlockEntryTest, MultiThreadedDllBranchEvents) {
   ASSERT_NO_FATAL_FAILURE(
       CheckThreadExecution(kDllMain, kBranchInstrumentation));
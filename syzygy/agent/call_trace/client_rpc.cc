@@ -178,6 +178,10 @@ class Client::ThreadLocalData {
   // Allocates a new enter event.
   TraceEnterEventData* AllocateEnterEvent();
 
+  // Appends an enter event to the current compact batch record, starting a
+  // new one if need be.
+  void AppendCompactEnterEvent(RetAddr retaddr, FuncAddr function);
+
   // Flushes the current trace file segment.
   bool FlushSegment();
 
@@ -191,6 +195,15 @@ class Client::ThreadLocalData {
   // The current batch record we're extending, if any.
   // This will point into the associated trace file segment's buffer.
   TraceBatchEnterData* batch;
+
+  // The current compact batch record we're extending, if any, and the
+  // addresses of its last call, against which the next one is encoded.
+  TraceCompactBatchEnterData* compact_batch;
+  RetAddr last_retaddr;
+  FuncAddr last_function;
+
+  // The function this thread last entered, if entries are filtered.
+  FuncAddr last_entered_function;
 };
 
 Client::Client() {
@@ -361,6 +374,19 @@ void Client::LogEvent_FunctionEntry(EntryFrame *entry_frame,
   //     the accuracy of the time for batch entry events. Do this before adding
   //     this event to the buffer in order to guarantee precision.
 
+  // Repeated entries add nothing to the order in which functions are first
+  // called, which is what the traces are used for, but can dominate them.
+  if (session_.IsEnabled(TRACE_FLAG_FILTER_REPEATED_ENTRIES)) {
+    if (function == data->last_entered_function)
+      return;
+    data->last_entered_function = function;
+  }
+
+  if (session_.IsEnabled(TRACE_FLAG_COMPACT_RECORDS)) {
+    data->AppendCompactEnterEvent(entry_frame->retaddr, function);
+    return;
+  }
+
   // Capture the basic call info and timestamp.
   TraceEnterEventData* enter = data->AllocateEnterEvent();
   if (enter != NULL) {
@@ -401,7 +427,13 @@ void Client::FreeThreadData() {
     FreeThreadData(data);
 }
 
-Client::ThreadLocalData::ThreadLocalData(Client* c) : client(c), batch(NULL) {
+Client::ThreadLocalData::ThreadLocalData(Client* c)
+    : client(c),
+      batch(NULL),
+      compact_batch(NULL),
+      last_retaddr(NULL),
+      last_function(NULL),
+      last_entered_function(NULL) {
 }
 
 TraceEnterEventData* Client::ThreadLocalData::AllocateEnterEvent() {
@@ -451,10 +483,53 @@ TraceEnterEventData* Client::ThreadLocalData::AllocateEnterEvent() {
   return &batch->calls[0];
 }
 
+void Client::ThreadLocalData::AppendCompactEnterEvent(RetAddr retaddr,
+                                                      FuncAddr function) {
+  const size_t kMaxCallLength = 2 * kMaxVarintLength;
+
+  // Do we need a new batch record, and maybe a new buffer?
+  if (compact_batch == NULL || !segment.CanAllocateRaw(kMaxCallLength)) {
+    if (compact_batch != NULL ||
+        !segment.CanAllocate(sizeof(TraceCompactBatchEnterData) +
+                             kMaxCallLength)) {
+      compact_batch = NULL;
+      if (!client->session_.ExchangeBuffer(&segment))
+        return;
+    }
+    compact_batch = segment.AllocateTraceRecord<TraceCompactBatchEnterData>();
+    last_retaddr = NULL;
+    last_function = NULL;
+  }
+
+  // As with the regular batches, the call is written before the enclosures
+  // are grown from the outermost inward, so that the buffer is consistent
+  // should the thread be terminated midway. The differences of the addresses
+  // wrap around, as they are unsigned.
+  uint8_t* call = segment.write_ptr;
+  size_t length = ::EncodeVarint(
+      ::ZigZagEncode(static_cast<intptr_t>(
+          reinterpret_cast<uintptr_t>(function) -
+          reinterpret_cast<uintptr_t>(last_function))),
+      call);
+  length += ::EncodeVarint(
+      ::ZigZagEncode(static_cast<intptr_t>(
+          reinterpret_cast<uintptr_t>(retaddr) -
+          reinterpret_cast<uintptr_t>(last_retaddr))),
+      call + length);
+  last_retaddr = retaddr;
+  last_function = function;
+
+  segment.write_ptr += length;
+  segment.header->segment_length += length;
+  trace::client::GetRecordPrefix(compact_batch)->size += length;
+  compact_batch->num_calls += 1;
+}
+
 bool Client::ThreadLocalData::FlushSegment() {
   DCHECK(IsInitialized());
 
   batch = NULL;
+  compact_batch = NULL;
   return client->session_.ExchangeBuffer(&segment);
 }
 
@@ -30,9 +30,13 @@
         'entry_frame.h',
         'hot_patcher.cc',
         'hot_patcher.h',
+        'module_bounds_cache.cc',
+        'module_bounds_cache.h',
         'process_utils.cc',
         'process_utils.h',
         'scoped_last_error_keeper.h',
+        'snapshot_trigger.cc',
+        'snapshot_trigger.h',
         'stack_capture.cc',
         'stack_capture.h',
         'stack_walker.cc',
@@ -54,7 +58,9 @@
         'dlist_unittest.cc',
         'dll_notifications_unittest.cc',
         'hot_patcher_unittest.cc',
+        'module_bounds_cache_unittest.cc',
         'process_utils_unittest.cc',
+        'snapshot_trigger_unittest.cc',
         'stack_capture_unittest.cc',
         'stack_walker_unittest.cc',
         'thread_state_unittest.cc',
@@ -21,6 +21,7 @@
 #undef WIN32_NO_STATUS
 #include <ntstatus.h>  // For STATUS_SUCCESS.
 
+#include "base/containers/hash_tables.h"
 #include "base/logging.h"
 
 
@@ -122,7 +123,8 @@ base::StringPiece16 ToStringPiece(const UNICODE_STRING* str) {
 
 }  // namespace
 
-DllNotificationWatcher::DllNotificationWatcher() : cookie_(NULL) {
+DllNotificationWatcher::DllNotificationWatcher()
+    : cookie_(NULL), queued_(false), pending_events_(NULL) {
 }
 
 DllNotificationWatcher::~DllNotificationWatcher() {
@@ -142,6 +144,87 @@ bool DllNotificationWatcher::Init(const CallbackType& callback) {
   return true;
 }
 
+bool DllNotificationWatcher::InitQueued(const CallbackType& callback) {
+  queued_ = true;
+  if (!Init(callback)) {
+    queued_ = false;
+    return false;
+  }
+  return true;
+}
+
+void DllNotificationWatcher::ProcessPendingEvents() {
+  if (!HasPendingEvents())
+    return;
+
+  // Another thread is delivering notifications, or this is a callback that
+  // caused more of them. Either way they'll be delivered on a later call.
+  if (!process_lock_.Try())
+    return;
+
+  PendingEvent* events = static_cast<PendingEvent*>(
+      ::InterlockedExchangePointer(
+          reinterpret_cast<PVOID volatile*>(&pending_events_), NULL));
+
+  // Put the events back in the order they occurred.
+  PendingEvent* ordered_events = NULL;
+  while (events != NULL) {
+    PendingEvent* next = events->next;
+    events->next = ordered_events;
+    ordered_events = events;
+    events = next;
+  }
+
+  // Modules that loaded and unloaded within the batch need not be seen at
+  // all, and couldn't safely be looked at anyway.
+  base::hash_map<HMODULE, PendingEvent*> loads;
+  for (PendingEvent* event = ordered_events; event != NULL;
+       event = event->next) {
+    if (event->type == kDllLoaded) {
+      loads[event->module] = event;
+      continue;
+    }
+    auto it = loads.find(event->module);
+    if (it != loads.end()) {
+      it->second->skipped = true;
+      event->skipped = true;
+      loads.erase(it);
+    }
+  }
+
+  for (PendingEvent* event = ordered_events; event != NULL;
+       event = event->next) {
+    if (event->skipped)
+      continue;
+
+    base::StringPiece16 dll_path(event->dll_path);
+    base::StringPiece16 dll_base_name(event->dll_base_name);
+    if (event->type == kDllUnloaded) {
+      callback_.Run(event->type, event->module, event->module_size, dll_path,
+                    dll_base_name);
+      continue;
+    }
+
+    // Hold a reference to the module while it's looked at, so that it can't
+    // be unloaded by another thread. A module that's already gone is skipped,
+    // and its unload notification is still to come.
+    HMODULE module = NULL;
+    if (!::GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+                             reinterpret_cast<LPCWSTR>(event->module),
+                             &module)) {
+      continue;
+    }
+    if (module == event->module) {
+      callback_.Run(event->type, event->module, event->module_size, dll_path,
+                    dll_base_name);
+    }
+    ::FreeLibrary(module);
+  }
+
+  DeleteEvents(ordered_events);
+  process_lock_.Release();
+}
+
 void DllNotificationWatcher::Reset() {
   if (cookie_ == NULL)
     return;
@@ -149,6 +232,36 @@ void DllNotificationWatcher::Reset() {
   CHECK(Unregister(cookie_));
   cookie_ = NULL;
   callback_.Reset();
+  queued_ = false;
+
+  DeleteEvents(static_cast<PendingEvent*>(
+      ::InterlockedExchangePointer(
+          reinterpret_cast<PVOID volatile*>(&pending_events_), NULL)));
+}
+
+void DllNotificationWatcher::PushEvent(PendingEvent* event) {
+  DCHECK_NE(static_cast<PendingEvent*>(NULL), event);
+
+  // The list is only ever taken whole, so there's no ABA problem here.
+  PendingEvent* head = pending_events_;
+  while (true) {
+    event->next = head;
+    PendingEvent* previous = static_cast<PendingEvent*>(
+        ::InterlockedCompareExchangePointer(
+            reinterpret_cast<PVOID volatile*>(&pending_events_), event, head));
+    if (previous == head)
+      break;
+    head = previous;
+  }
+}
+
+// static
+void DllNotificationWatcher::DeleteEvents(PendingEvent* events) {
+  while (events != NULL) {
+    PendingEvent* next = events->next;
+    delete events;
+    events = next;
+  }
 }
 
 void CALLBACK DllNotificationWatcher::NotificationFunction(
@@ -185,6 +298,18 @@ void CALLBACK DllNotificationWatcher::NotificationFunction(
       return;
   }
 
+  if (self->queued_) {
+    PendingEvent* event = new PendingEvent();
+    event->type = event_type;
+    event->module = module;
+    event->module_size = module_size;
+    event->skipped = false;
+    dll_path.CopyToString(&event->dll_path);
+    dll_base_name.CopyToString(&event->dll_base_name);
+    self->PushEvent(event);
+    return;
+  }
+
   self->callback_.Run(event_type, module, module_size, dll_path, dll_base_name);
 }
 
@@ -14,14 +14,22 @@
 //
 // Declares a utility class to get DLL load/unload notifications on supporting
 // systems - Vista and up.
+//
+// Notifications are delivered under the loader lock. Callers that do more than
+// a little work per notification can instead have them queued, and process
+// them in batches outside the loader lock.
 
 #ifndef SYZYGY_AGENT_COMMON_DLL_NOTIFICATIONS_H_
 #define SYZYGY_AGENT_COMMON_DLL_NOTIFICATIONS_H_
 
 #include <windows.h>
 
+#include <string>
+
 #include "base/callback.h"
+#include "base/macros.h"
 #include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
 
 // Forward decl.
 union _LDR_DLL_NOTIFICATION_DATA;
@@ -52,20 +60,72 @@ class DllNotificationWatcher {
   //     mechanism, Windows XP and earlier.
   bool Init(const CallbackType& callback);
 
-  // Uninitialize and unregister from further callbacks.
+  // Initialize for queued notifications to @p callback. The notifications are
+  // only recorded under the loader lock, and delivered on the next call to
+  // ProcessPendingEvents.
+  // @param callback The callback to deliver the notifications to.
+  // @returns true on success, false on failure.
+  // @note A load notification is dropped if its module is no longer loaded
+  //     when it's processed, but the matching unload notification is still
+  //     delivered. Callers must therefore tolerate unloads of modules they
+  //     haven't seen load.
+  bool InitQueued(const CallbackType& callback);
+
+  // Delivers the queued notifications, in the order they occurred. This is
+  // a no-op if another thread is processing them, or if it is called from the
+  // callback.
+  void ProcessPendingEvents();
+
+  // @returns true if there are queued notifications. This is cheap enough to
+  //     be checked on every call of an agent hook.
+  bool HasPendingEvents() const { return pending_events_ != NULL; }
+
+  // Uninitialize and unregister from further callbacks. Queued notifications
+  // are discarded.
   // @note From observation, the registration and unregistration are done under
   //     loader's lock, so there's no danger of callbacks after this function
   //     returns.
   void Reset();
 
  private:
+  // A queued notification.
+  struct PendingEvent {
+    PendingEvent* next;
+    EventType type;
+    HMODULE module;
+    size_t module_size;
+    std::wstring dll_path;
+    std::wstring dll_base_name;
+    // Set for the loads and unloads that cancel out within a batch.
+    bool skipped;
+  };
+
   static void CALLBACK NotificationFunction(
       ULONG reason,
       const union _LDR_DLL_NOTIFICATION_DATA* data,
       void* context);
 
+  // Queues a notification. This is lock-free.
+  void PushEvent(PendingEvent* event);
+
+  // Deletes the events of a list linked by their next fields.
+  static void DeleteEvents(PendingEvent* events);
+
   CallbackType callback_;
   void* cookie_;
+
+  // True if the notifications are queued rather than delivered right away.
+  bool queued_;
+
+  // The queued notifications, most recent first. Pushed to without a lock, and
+  // taken whole by ProcessPendingEvents.
+  PendingEvent* volatile pending_events_;
+
+  // Serializes ProcessPendingEvents, so that the notifications are delivered
+  // in order.
+  base::Lock process_lock_;
+
+  DISALLOW_COPY_AND_ASSIGN(DllNotificationWatcher);
 };
 
 }  // namespace common
@@ -108,6 +108,61 @@ TEST_F(DllNotificationWatcherTest, Init) {
   UnloadTestDll();
 }
 
+TEST_F(DllNotificationWatcherTest, InitQueued) {
+  DllNotificationWatcher watcher;
+
+  ASSERT_TRUE(watcher.InitQueued(
+      base::Bind(&NotificationReceiver::OnNotification,
+                 base::Unretained(&receiver_))));
+  EXPECT_FALSE(watcher.HasPendingEvents());
+
+  // The notifications are only delivered once processed.
+  ASSERT_NO_FATAL_FAILURE(LoadTestDll());
+  EXPECT_TRUE(watcher.HasPendingEvents());
+
+  EXPECT_CALL(receiver_,
+              OnNotification(DllNotificationWatcher::kDllLoaded,
+                             _, _,
+                             testing::Eq(test_dll_path_.value()),
+                             testing::Eq(test_dll_path_.BaseName().value())));
+  EXPECT_CALL(receiver_,
+              OnNotification(DllNotificationWatcher::kDllLoaded,
+                             _, _,
+                             _,
+                             testing::Eq(L"export_dll.dll")));
+  watcher.ProcessPendingEvents();
+  EXPECT_FALSE(watcher.HasPendingEvents());
+  testing::Mock::VerifyAndClearExpectations(&receiver_);
+
+  UnloadTestDll();
+  EXPECT_CALL(receiver_,
+              OnNotification(DllNotificationWatcher::kDllUnloaded,
+                             _, _,
+                             testing::Eq(test_dll_path_.value()),
+                             testing::Eq(test_dll_path_.BaseName().value())));
+  EXPECT_CALL(receiver_,
+              OnNotification(DllNotificationWatcher::kDllUnloaded,
+                             _, _,
+                             _,
+                             testing::Eq(L"export_dll.dll")));
+  watcher.ProcessPendingEvents();
+}
+
+TEST_F(DllNotificationWatcherTest, QueuedLoadAndUnloadCancelOut) {
+  DllNotificationWatcher watcher;
+
+  ASSERT_TRUE(watcher.InitQueued(
+      base::Bind(&NotificationReceiver::OnNotification,
+                 base::Unretained(&receiver_))));
+
+  // A module that's gone by the time the batch is processed isn't seen.
+  ASSERT_NO_FATAL_FAILURE(LoadTestDll());
+  UnloadTestDll();
+  EXPECT_TRUE(watcher.HasPendingEvents());
+  watcher.ProcessPendingEvents();
+  EXPECT_FALSE(watcher.HasPendingEvents());
+}
+
 TEST_F(DllNotificationWatcherTest, Reset) {
   DllNotificationWatcher watcher;
 
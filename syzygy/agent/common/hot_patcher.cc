@@ -17,18 +17,39 @@
 #include <stdint.h>
 #include <windows.h>
 
+#include <algorithm>
+
 #include "base/logging.h"
 #include "syzygy/common/com_utils.h"
 
 namespace agent {
 namespace common {
 
+namespace {
+
+// The hot patching starts this many bytes before the entry point of the
+// function, and writes this many bytes in all.
+const size_t kHotPatchPrefixSize = 5U;
+const size_t kHotPatchLength = 7U;
+
+// @returns true if @p protection allows executing.
+bool IsExecutable(DWORD protection) {
+  return ((PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE |
+           PAGE_EXECUTE_WRITECOPY) & protection) != 0;
+}
+
+bool SiteLess(const HotPatcher::PatchSite& a, const HotPatcher::PatchSite& b) {
+  return a.function_entry_point < b.function_entry_point;
+}
+
+}  // namespace
+
 bool HotPatcher::Patch(FunctionPointer function_entry_point,
                        FunctionPointer new_entry_point) {
   // The hot patching starts 5 bytes before the entry point of the function.
   uint8_t* hot_patch_start =
-      reinterpret_cast<uint8_t*>(function_entry_point) - 5;
-  const size_t hot_patch_length = 7U;
+      reinterpret_cast<uint8_t*>(function_entry_point) - kHotPatchPrefixSize;
+  const size_t hot_patch_length = kHotPatchLength;
 
   // Change the page protection so that we can write.
   MEMORY_BASIC_INFORMATION memory_info;
@@ -40,20 +61,133 @@ bool HotPatcher::Patch(FunctionPointer function_entry_point,
     return false;
   }
 
-  DWORD is_executable = (PAGE_EXECUTE | PAGE_EXECUTE_READ |
-                         PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY) &
-                        memory_info.Protect;
-
   if (!::VirtualProtect(reinterpret_cast<LPVOID>(hot_patch_start),
                         hot_patch_length,
-                        is_executable ? PAGE_EXECUTE_READWRITE :
-                                        PAGE_READWRITE,
+                        IsExecutable(memory_info.Protect) ?
+                            PAGE_EXECUTE_READWRITE : PAGE_READWRITE,
                         &old_page_protection)) {
     LOG(ERROR) << "Could not grant write privileges to page. Error code: "
                << ::common::LogWe();
     return false;
   }
 
+  WritePatch(function_entry_point, new_entry_point);
+
+  // Restore the old page protection.
+  if (!::VirtualProtect(reinterpret_cast<LPVOID>(hot_patch_start),
+                        hot_patch_length,
+                        old_page_protection,
+                        &old_page_protection)) {
+    // We do not return false if this fails as the hot patching already
+    // happened.
+    LOG(ERROR) << "Could not reset old privileges to page. Error code: "
+               << ::common::LogWe();
+  }
+
+  return true;
+}
+
+bool HotPatcher::PatchFunctions(const PatchSites& sites) {
+  if (sites.empty())
+    return true;
+
+  PatchSites sorted_sites(sites);
+  std::sort(sorted_sites.begin(), sorted_sites.end(), SiteLess);
+
+  // Validate everything before writing anything.
+  for (size_t i = 1; i < sorted_sites.size(); ++i) {
+    const uint8_t* previous_end =
+        static_cast<uint8_t*>(sorted_sites[i - 1].function_entry_point) +
+        kHotPatchLength - kHotPatchPrefixSize;
+    const uint8_t* start =
+        static_cast<uint8_t*>(sorted_sites[i].function_entry_point) -
+        kHotPatchPrefixSize;
+    if (start < previous_end) {
+      LOG(ERROR) << "Overlapping hot patch sites at "
+                 << sorted_sites[i].function_entry_point << ".";
+      return false;
+    }
+  }
+
+  uint8_t* patched_start =
+      static_cast<uint8_t*>(sorted_sites.front().function_entry_point) -
+      kHotPatchPrefixSize;
+  uint8_t* patched_end = patched_start;
+
+  // Flip the protection once for each run of sites sharing a memory region,
+  // which has a single protection to restore.
+  size_t i = 0;
+  while (i < sorted_sites.size()) {
+    uint8_t* run_start =
+        static_cast<uint8_t*>(sorted_sites[i].function_entry_point) -
+        kHotPatchPrefixSize;
+
+    MEMORY_BASIC_INFORMATION memory_info;
+    if (!::VirtualQuery(run_start, &memory_info, sizeof(memory_info))) {
+      LOG(ERROR) << "Could not execute VirtualQuery(). Error code: "
+                 << ::common::LogWe();
+      return false;
+    }
+    const uint8_t* region_end =
+        static_cast<uint8_t*>(memory_info.BaseAddress) +
+        memory_info.RegionSize;
+
+    // A site straddling the end of the region makes a run of its own.
+    size_t run_end_index = i + 1;
+    uint8_t* run_end = run_start + kHotPatchLength;
+    while (run_end_index < sorted_sites.size()) {
+      uint8_t* site_end = static_cast<uint8_t*>(
+          sorted_sites[run_end_index].function_entry_point) +
+          kHotPatchLength - kHotPatchPrefixSize;
+      if (site_end > region_end)
+        break;
+      run_end = site_end;
+      ++run_end_index;
+    }
+
+    DWORD old_page_protection = 0;
+    if (!::VirtualProtect(run_start,
+                          run_end - run_start,
+                          IsExecutable(memory_info.Protect) ?
+                              PAGE_EXECUTE_READWRITE : PAGE_READWRITE,
+                          &old_page_protection)) {
+      LOG(ERROR) << "Could not grant write privileges to page. Error code: "
+                 << ::common::LogWe();
+      return false;
+    }
+
+    for (; i < run_end_index; ++i) {
+      WritePatch(sorted_sites[i].function_entry_point,
+                 sorted_sites[i].new_entry_point);
+    }
+    patched_end = run_end;
+
+    if (!::VirtualProtect(run_start,
+                          run_end - run_start,
+                          old_page_protection,
+                          &old_page_protection)) {
+      // We do not return false if this fails as the hot patching already
+      // happened.
+      LOG(ERROR) << "Could not reset old privileges to page. Error code: "
+                 << ::common::LogWe();
+    }
+  }
+
+  if (!::FlushInstructionCache(::GetCurrentProcess(), patched_start,
+                               patched_end - patched_start)) {
+    LOG(ERROR) << "Could not flush the instruction cache. Error code: "
+               << ::common::LogWe();
+  }
+
+  return true;
+}
+
+// static
+void HotPatcher::WritePatch(FunctionPointer function_entry_point,
+                            FunctionPointer new_entry_point) {
+  uint8_t* hot_patch_start =
+      reinterpret_cast<uint8_t*>(function_entry_point) - kHotPatchPrefixSize;
+
   // The location where we have to write the PC-relative address of the new
   // entry point.
   int32_t* new_entry_point_place =
@@ -84,19 +218,6 @@ bool HotPatcher::Patch(FunctionPointer function_entry_point,
   // We reverse the order of the bytes because of the little endian encoding
   // to get the final value 0xF9EB.
   *jump_hook_place = 0xF9EB;
-
-  // Restore the old page protection.
-  if (!::VirtualProtect(reinterpret_cast<LPVOID>(hot_patch_start),
-                        hot_patch_length,
-                        old_page_protection,
-                        &old_page_protection)) {
-    // We do not return false if this fails as the hot patching already
-    // happened.
-    LOG(ERROR) << "Could not reset old privileges to page. Error code: "
-               << ::common::LogWe();
-  }
-
-  return true;
 }
 
 }  // namespace common
@@ -32,10 +32,17 @@
 // We also DCHECK that the bytes in the padding that we overwrite are all 0xCC
 // bytes. These are used by the instrumenter in the paddings. These DCHECKs
 // need to be removed to support hot patching a function more than once.
+//
+// Many functions, such as all the blocks listed in the hot patching metadata
+// of a module, are best patched at once with PatchFunctions. It validates all
+// of them before writing anything, changes the protection once per run of
+// patch sites sharing a memory region, and flushes the instruction cache once.
 
 #ifndef SYZYGY_AGENT_COMMON_HOT_PATCHER_H_
 #define SYZYGY_AGENT_COMMON_HOT_PATCHER_H_
 
+#include <vector>
+
 #include <base/macros.h>
 
 namespace agent {
@@ -45,6 +52,13 @@ class HotPatcher {
  public:
   typedef void* FunctionPointer;
 
+  // A function to hot patch, and the function to redirect it to.
+  struct PatchSite {
+    FunctionPointer function_entry_point;
+    FunctionPointer new_entry_point;
+  };
+  typedef std::vector<PatchSite> PatchSites;
+
   HotPatcher() { }
   ~HotPatcher() { }
 
@@ -60,7 +74,22 @@ class HotPatcher {
   bool Patch(FunctionPointer function_entry_point,
              FunctionPointer new_entry_point);
 
+  // Applies hot patching to a set of functions.
+  // @param sites The functions to patch, in any order.
+  // @returns true on success, false on failure. Nothing is written if the
+  //     sites overlap, but the functions patched before a failure to change
+  //     the protection of a later region stay patched.
+  // @pre Each function must satisfy the preconditions of Patch.
+  bool PatchFunctions(const PatchSites& sites);
+
  private:
+  // Writes the jumps redirecting a function to another.
+  // @param function_entry_point The start address of the function.
+  // @param new_entry_point The function to redirect to.
+  // @pre The bytes to write must be writable.
+  static void WritePatch(FunctionPointer function_entry_point,
+                         FunctionPointer new_entry_point);
+
   DISALLOW_COPY_AND_ASSIGN(HotPatcher);
 };
 
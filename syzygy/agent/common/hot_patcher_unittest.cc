@@ -17,6 +17,8 @@
 #include <stdint.h>
 #include <windows.h>
 
+#include <vector>
+
 #include "gtest/gtest.h"
 
 namespace agent {
@@ -147,5 +149,68 @@ TEST_F(HotPatcherTest, TestPageBoundary) {
   ASSERT_NO_FATAL_FAILURE(RunTest(page_size_ * 2, page_size_ - 4));
 }
 
+TEST_F(HotPatcherTest, PatchFunctions) {
+  // Lay out copies of the test function on two pages, one of them straddling
+  // the boundary.
+  const size_t virtual_memory_size = page_size_ * 2;
+  LPVOID virtual_memory = ::VirtualAlloc(nullptr,
+                                         virtual_memory_size,
+                                         MEM_COMMIT,
+                                         PAGE_READWRITE);
+  ASSERT_NE(nullptr, virtual_memory);
+  uint8_t* memory = static_cast<uint8_t*>(virtual_memory);
+  const size_t kOffsets[] = { 0U, sizeof(kTestFunction), page_size_ - 4,
+                              page_size_ + 64 };
+  for (size_t offset : kOffsets)
+    ::memcpy(memory + offset, kTestFunction, sizeof(kTestFunction));
+
+  DWORD old_protection;
+  ASSERT_TRUE(::VirtualProtect(virtual_memory,
+                               virtual_memory_size,
+                               PAGE_EXECUTE_READ,
+                               &old_protection));
+
+  // Patch the functions in reverse order, as the order shouldn't matter.
+  HotPatcher::PatchSites sites;
+  std::vector<TestFunctionPtr> test_functions;
+  for (size_t offset : kOffsets) {
+    TestFunctionPtr test_function = reinterpret_cast<TestFunctionPtr>(
+        memory + offset + kNumberOfPaddingBytesInTestFunction);
+    ASSERT_EQ(1, test_function());
+    HotPatcher::PatchSite site = { test_function, &NewFunction };
+    sites.insert(sites.begin(), site);
+    test_functions.push_back(test_function);
+  }
+
+  HotPatcher hot_patcher;
+  ASSERT_TRUE(hot_patcher.PatchFunctions(sites));
+  for (TestFunctionPtr test_function : test_functions)
+    EXPECT_EQ(42, test_function());
+
+  // Check that the protection is kept.
+  MEMORY_BASIC_INFORMATION meminfo;
+  ASSERT_NE(0U, ::VirtualQuery(virtual_memory, &meminfo, sizeof(meminfo)));
+  EXPECT_EQ(virtual_memory_size, meminfo.RegionSize);
+  EXPECT_EQ(PAGE_EXECUTE_READ, meminfo.Protect);
+
+  EXPECT_TRUE(::VirtualFree(virtual_memory, 0, MEM_RELEASE));
+}
+
+TEST_F(HotPatcherTest, PatchFunctionsFailsOnOverlappingSites) {
+  uint8_t memory[2 * sizeof(kTestFunction)] = {};
+  ::memcpy(memory, kTestFunction, sizeof(kTestFunction));
+  void* test_function = memory + kNumberOfPaddingBytesInTestFunction;
+
+  // Patching the same function twice would overwrite its first patch.
+  HotPatcher::PatchSites sites;
+  HotPatcher::PatchSite site = { test_function, &NewFunction };
+  sites.push_back(site);
+  sites.push_back(site);
+
+  HotPatcher hot_patcher;
+  EXPECT_FALSE(hot_patcher.PatchFunctions(sites));
+  EXPECT_EQ(0, ::memcmp(memory, kTestFunction, sizeof(kTestFunction)));
+}
+
 }  // namespace common
 }  // namespace agent
@@ -0,0 +1,157 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/common/module_bounds_cache.h"
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/logging.h"
+#include "base/win/pe_image.h"
+#include "syzygy/common/process_utils.h"
+
+namespace agent {
+namespace common {
+
+namespace {
+
+// Orders module bounds by address, and allows looking up an address.
+struct ModuleBoundsEndLess {
+  template <typename ModuleBounds>
+  bool operator()(const ModuleBounds& bounds, uintptr_t address) const {
+    return bounds.end <= address;
+  }
+};
+
+}  // namespace
+
+ModuleBoundsCache::ModuleBoundsCache() {
+}
+
+ModuleBoundsCache::~ModuleBoundsCache() {
+  TearDown();
+}
+
+bool ModuleBoundsCache::Init() {
+  // Start watching before enumerating, so that no module can be missed.
+  if (!watcher_.Init(base::Bind(&ModuleBoundsCache::OnDllNotification,
+                                base::Unretained(this)))) {
+    return false;
+  }
+
+  ::common::ModuleVector modules;
+  if (!::common::GetCurrentProcessModules(&modules)) {
+    TearDown();
+    return false;
+  }
+
+  for (HMODULE module : modules) {
+    base::win::PEImage image(module);
+    if (!image.VerifyMagic())
+      continue;
+    AddModule(module, image.GetNTHeaders()->OptionalHeader.SizeOfImage);
+  }
+
+  return true;
+}
+
+void ModuleBoundsCache::TearDown() {
+  watcher_.Reset();
+
+  base::AutoLock auto_lock(lock_);
+  modules_.clear();
+}
+
+HMODULE ModuleBoundsCache::GetModuleFromAddress(const void* address) const {
+  base::AutoLock auto_lock(lock_);
+  return FindModuleUnlocked(address);
+}
+
+void ModuleBoundsCache::GetModulesFromAddresses(const void* const* addresses,
+                                                size_t count,
+                                                HMODULE* modules) const {
+  DCHECK(count == 0 || addresses != nullptr);
+  DCHECK(count == 0 || modules != nullptr);
+
+  base::AutoLock auto_lock(lock_);
+  for (size_t i = 0; i < count; ++i)
+    modules[i] = FindModuleUnlocked(addresses[i]);
+}
+
+size_t ModuleBoundsCache::module_count() const {
+  base::AutoLock auto_lock(lock_);
+  return modules_.size();
+}
+
+void ModuleBoundsCache::AddModule(HMODULE module, size_t module_size) {
+  DCHECK_NE(static_cast<HMODULE>(nullptr), module);
+  DCHECK_LT(0u, module_size);
+
+  ModuleBounds bounds = { reinterpret_cast<uintptr_t>(module),
+                          reinterpret_cast<uintptr_t>(module) + module_size };
+
+  base::AutoLock auto_lock(lock_);
+  auto it = std::lower_bound(modules_.begin(), modules_.end(), bounds.start,
+                             ModuleBoundsEndLess());
+  if (it != modules_.end() && it->start == bounds.start)
+    return;
+  // Modules can't overlap.
+  DCHECK(it == modules_.end() || bounds.end <= it->start);
+  modules_.insert(it, bounds);
+}
+
+void ModuleBoundsCache::RemoveModule(HMODULE module) {
+  uintptr_t start = reinterpret_cast<uintptr_t>(module);
+
+  base::AutoLock auto_lock(lock_);
+  auto it = std::lower_bound(modules_.begin(), modules_.end(), start,
+                             ModuleBoundsEndLess());
+  if (it != modules_.end() && it->start == start)
+    modules_.erase(it);
+}
+
+void ModuleBoundsCache::OnDllNotification(
+    DllNotificationWatcher::EventType type,
+    HMODULE module,
+    size_t module_size,
+    const base::StringPiece16& dll_path,
+    const base::StringPiece16& dll_base_name) {
+  switch (type) {
+    case DllNotificationWatcher::kDllLoaded:
+      AddModule(module, module_size);
+      break;
+
+    case DllNotificationWatcher::kDllUnloaded:
+      RemoveModule(module);
+      break;
+
+    default:
+      NOTREACHED();
+      break;
+  }
+}
+
+HMODULE ModuleBoundsCache::FindModuleUnlocked(const void* address) const {
+  lock_.AssertAcquired();
+
+  uintptr_t value = reinterpret_cast<uintptr_t>(address);
+  auto it = std::lower_bound(modules_.begin(), modules_.end(), value,
+                             ModuleBoundsEndLess());
+  if (it == modules_.end() || value < it->start)
+    return nullptr;
+  return reinterpret_cast<HMODULE>(it->start);
+}
+
+}  // namespace common
+}  // namespace agent
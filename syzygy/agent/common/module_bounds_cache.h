@@ -0,0 +1,114 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a cache of the address ranges of the modules loaded in the current
+// process. Finding the module containing an address via the OS takes the
+// loader lock, which is far too expensive to do for every frame of every
+// stack capture. This cache is instead kept up to date via DLL load and unload
+// notifications, and looked up with a binary search.
+
+#ifndef SYZYGY_AGENT_COMMON_MODULE_BOUNDS_CACHE_H_
+#define SYZYGY_AGENT_COMMON_MODULE_BOUNDS_CACHE_H_
+
+#include <windows.h>
+
+#include <vector>
+
+#include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
+#include "syzygy/agent/common/dll_notifications.h"
+
+namespace agent {
+namespace common {
+
+class ModuleBoundsCache {
+ public:
+  ModuleBoundsCache();
+  ~ModuleBoundsCache();
+
+  // Starts watching the DLL notifications, and populates the cache with the
+  // modules that are already loaded.
+  // @returns true on success, false otherwise.
+  // @note this fails on systems that don't provide DLL notifications, as the
+  //     cache would then go stale.
+  bool Init();
+
+  // Stops watching the DLL notifications and empties the cache.
+  void TearDown();
+
+  // Finds the module containing an address.
+  // @param address The address to look up.
+  // @returns the module containing @p address, or nullptr if there is none.
+  HMODULE GetModuleFromAddress(const void* address) const;
+
+  // Finds the modules containing a set of addresses. This only takes the lock
+  // once, and should be preferred for looking up all the frames of a stack.
+  // @param addresses The addresses to look up.
+  // @param count The number of addresses.
+  // @param modules Will receive the module containing each address, or
+  //     nullptr for the addresses that aren't in any module.
+  void GetModulesFromAddresses(const void* const* addresses,
+                               size_t count,
+                               HMODULE* modules) const;
+
+  // @returns the number of modules in the cache.
+  size_t module_count() const;
+
+ protected:
+  // The bounds of a module. These are kept in a vector sorted by address.
+  struct ModuleBounds {
+    uintptr_t start;
+    uintptr_t end;
+  };
+  typedef std::vector<ModuleBounds> ModuleBoundsVector;
+
+  // Adds a module to the cache. Adding a module that is already present is
+  // a no-op, as notifications can race with the initial enumeration.
+  // @param module The module to add.
+  // @param module_size The size of the module, in bytes.
+  void AddModule(HMODULE module, size_t module_size);
+
+  // Removes a module from the cache, if present.
+  // @param module The module to remove.
+  void RemoveModule(HMODULE module);
+
+  // The DLL notification callback.
+  void OnDllNotification(DllNotificationWatcher::EventType type,
+                         HMODULE module,
+                         size_t module_size,
+                         const base::StringPiece16& dll_path,
+                         const base::StringPiece16& dll_base_name);
+
+  // Finds the module containing an address. Must be called under lock_.
+  // @param address The address to look up.
+  // @returns the module containing @p address, or nullptr if there is none.
+  HMODULE FindModuleUnlocked(const void* address) const;
+
+  // The watcher keeping the cache up to date.
+  DllNotificationWatcher watcher_;
+
+  // Protects modules_.
+  mutable base::Lock lock_;
+
+  // The bounds of the loaded modules, sorted by address. Under lock_.
+  ModuleBoundsVector modules_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ModuleBoundsCache);
+};
+
+}  // namespace common
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_COMMON_MODULE_BOUNDS_CACHE_H_
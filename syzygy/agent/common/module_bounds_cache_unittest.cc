@@ -0,0 +1,136 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/common/module_bounds_cache.h"
+
+#include "base/files/file_path.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+
+namespace agent {
+namespace common {
+
+namespace {
+
+const HMODULE kNoModule = nullptr;
+
+class TestModuleBoundsCache : public ModuleBoundsCache {
+ public:
+  using ModuleBoundsCache::AddModule;
+  using ModuleBoundsCache::RemoveModule;
+};
+
+class ModuleBoundsCacheTest : public testing::Test {
+ public:
+  ModuleBoundsCacheTest() : test_dll_(nullptr) {
+  }
+
+  void TearDown() override {
+    if (test_dll_ != nullptr)
+      ::FreeLibrary(test_dll_);
+  }
+
+  void LoadTestDll() {
+    base::FilePath test_dll_path =
+        testing::GetExeRelativePath(L"test_dll.dll");
+    test_dll_ = ::LoadLibrary(test_dll_path.value().c_str());
+    ASSERT_NE(static_cast<HMODULE>(nullptr), test_dll_);
+  }
+
+  void UnloadTestDll() {
+    ASSERT_NE(static_cast<HMODULE>(nullptr), test_dll_);
+    ASSERT_TRUE(::FreeLibrary(test_dll_));
+    test_dll_ = nullptr;
+  }
+
+  HMODULE test_dll_;
+};
+
+}  // namespace
+
+TEST_F(ModuleBoundsCacheTest, AddAndRemoveModules) {
+  TestModuleBoundsCache cache;
+  uint8_t* base = reinterpret_cast<uint8_t*>(0x10000000);
+  HMODULE module1 = reinterpret_cast<HMODULE>(base);
+  HMODULE module2 = reinterpret_cast<HMODULE>(base + 0x3000);
+
+  EXPECT_EQ(0u, cache.module_count());
+  cache.AddModule(module2, 0x1000);
+  cache.AddModule(module1, 0x2000);
+  // Adding a module twice is harmless.
+  cache.AddModule(module1, 0x2000);
+  EXPECT_EQ(2u, cache.module_count());
+
+  EXPECT_EQ(kNoModule, cache.GetModuleFromAddress(base - 1));
+  EXPECT_EQ(module1, cache.GetModuleFromAddress(base));
+  EXPECT_EQ(module1, cache.GetModuleFromAddress(base + 0x1FFF));
+  EXPECT_EQ(kNoModule, cache.GetModuleFromAddress(base + 0x2000));
+  EXPECT_EQ(module2, cache.GetModuleFromAddress(base + 0x3000));
+  EXPECT_EQ(module2, cache.GetModuleFromAddress(base + 0x3FFF));
+  EXPECT_EQ(kNoModule, cache.GetModuleFromAddress(base + 0x4000));
+
+  const void* addresses[] = { base + 0x3800, base + 0x2800, base + 0x10 };
+  HMODULE modules[arraysize(addresses)] = {};
+  cache.GetModulesFromAddresses(addresses, arraysize(addresses), modules);
+  EXPECT_EQ(module2, modules[0]);
+  EXPECT_EQ(kNoModule, modules[1]);
+  EXPECT_EQ(module1, modules[2]);
+
+  cache.RemoveModule(module1);
+  EXPECT_EQ(1u, cache.module_count());
+  EXPECT_EQ(kNoModule, cache.GetModuleFromAddress(base));
+  EXPECT_EQ(module2, cache.GetModuleFromAddress(base + 0x3000));
+
+  // Removing an unknown module is harmless.
+  cache.RemoveModule(module1);
+  EXPECT_EQ(1u, cache.module_count());
+}
+
+TEST_F(ModuleBoundsCacheTest, InitFindsLoadedModules) {
+  ModuleBoundsCache cache;
+  ASSERT_TRUE(cache.Init());
+  EXPECT_LT(0u, cache.module_count());
+
+  // Both the executable and a system module should be found.
+  HMODULE exe = ::GetModuleHandle(nullptr);
+  EXPECT_EQ(exe, cache.GetModuleFromAddress(exe));
+  HMODULE kernel32 = ::GetModuleHandle(L"kernel32.dll");
+  void* function = ::GetProcAddress(kernel32, "GetProcAddress");
+  EXPECT_EQ(kernel32, cache.GetModuleFromAddress(function));
+
+  // The stack isn't in any module.
+  int local = 0;
+  EXPECT_EQ(kNoModule, cache.GetModuleFromAddress(&local));
+
+  cache.TearDown();
+  EXPECT_EQ(0u, cache.module_count());
+}
+
+TEST_F(ModuleBoundsCacheTest, TracksLoadAndUnload) {
+  ModuleBoundsCache cache;
+  ASSERT_TRUE(cache.Init());
+  size_t module_count = cache.module_count();
+
+  ASSERT_NO_FATAL_FAILURE(LoadTestDll());
+  EXPECT_EQ(module_count + 1, cache.module_count());
+  HMODULE test_dll = test_dll_;
+  EXPECT_EQ(test_dll, cache.GetModuleFromAddress(test_dll));
+
+  ASSERT_NO_FATAL_FAILURE(UnloadTestDll());
+  EXPECT_EQ(module_count, cache.module_count());
+  EXPECT_EQ(kNoModule, cache.GetModuleFromAddress(test_dll));
+}
+
+}  // namespace common
+}  // namespace agent
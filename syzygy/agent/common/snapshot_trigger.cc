@@ -0,0 +1,128 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/common/snapshot_trigger.h"
+
+#include <memory>
+
+#include "base/environment.h"
+#include "base/logging.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/utf_string_conversions.h"
+#include "syzygy/common/com_utils.h"
+#include "syzygy/common/indexed_frequency_data.h"
+
+namespace agent {
+namespace common {
+
+SnapshotTrigger::SnapshotTrigger() : wait_handle_(NULL) {
+}
+
+SnapshotTrigger::~SnapshotTrigger() {
+  Stop();
+}
+
+bool SnapshotTrigger::Start(const std::wstring& event_name,
+                            base::TimeDelta interval,
+                            const base::Closure& callback) {
+  DCHECK(!started());
+  DCHECK(!callback.is_null());
+
+  if (event_name.empty() && interval <= base::TimeDelta()) {
+    LOG(ERROR) << "A snapshot trigger needs an event or an interval.";
+    return false;
+  }
+
+  event_.Set(::CreateEvent(NULL, FALSE, FALSE,
+                           event_name.empty() ? NULL : event_name.c_str()));
+  if (!event_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create snapshot event \"" << event_name << "\": "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  callback_ = callback;
+  ULONG timeout = INFINITE;
+  if (interval > base::TimeDelta())
+    timeout = static_cast<ULONG>(interval.InMilliseconds());
+  if (!::RegisterWaitForSingleObject(&wait_handle_, event_.Get(),
+                                     &SnapshotTrigger::OnWaitCompleted, this,
+                                     timeout, WT_EXECUTELONGFUNCTION)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to register the snapshot wait: "
+               << ::common::LogWe(error) << ".";
+    wait_handle_ = NULL;
+    callback_.Reset();
+    event_.Close();
+    return false;
+  }
+
+  return true;
+}
+
+bool SnapshotTrigger::StartFromEnvironment(const base::Closure& callback) {
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+
+  std::wstring event_name;
+  std::string event_base_name;
+  if (env->GetVar(::common::kIndexedFrequencySnapshotEventEnvVar,
+                  &event_base_name) && !event_base_name.empty()) {
+    event_name = ::common::GetIndexedFrequencySnapshotEventName(
+        base::UTF8ToWide(event_base_name), ::GetCurrentProcessId());
+  }
+
+  base::TimeDelta interval;
+  std::string interval_ms;
+  if (env->GetVar(::common::kIndexedFrequencySnapshotIntervalEnvVar,
+                  &interval_ms)) {
+    unsigned int value = 0;
+    if (!base::StringToUint(interval_ms, &value)) {
+      LOG(ERROR) << "Invalid snapshot interval: " << interval_ms << ".";
+      return false;
+    }
+    interval = base::TimeDelta::FromMilliseconds(value);
+  }
+
+  // Snapshots weren't asked for.
+  if (event_name.empty() && interval.is_zero())
+    return true;
+
+  return Start(event_name, interval, callback);
+}
+
+void SnapshotTrigger::Stop() {
+  if (!started())
+    return;
+
+  // Blocks until the callbacks in progress have returned.
+  if (!::UnregisterWaitEx(wait_handle_, INVALID_HANDLE_VALUE)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to unregister the snapshot wait: "
+               << ::common::LogWe(error) << ".";
+  }
+  wait_handle_ = NULL;
+  callback_.Reset();
+  event_.Close();
+}
+
+void CALLBACK SnapshotTrigger::OnWaitCompleted(void* context,
+                                               BOOLEAN timer_fired) {
+  SnapshotTrigger* self = reinterpret_cast<SnapshotTrigger*>(context);
+  DCHECK(self != NULL);
+  self->callback_.Run();
+}
+
+}  // namespace common
+}  // namespace agent
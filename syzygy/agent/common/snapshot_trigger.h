@@ -0,0 +1,92 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a utility class that invokes a callback periodically and/or when a
+// named event is signalled, so that agents can ship snapshots of the data they
+// gather while the instrumented process keeps running.
+
+#ifndef SYZYGY_AGENT_COMMON_SNAPSHOT_TRIGGER_H_
+#define SYZYGY_AGENT_COMMON_SNAPSHOT_TRIGGER_H_
+
+#include <windows.h>
+
+#include <string>
+
+#include "base/callback.h"
+#include "base/macros.h"
+#include "base/time/time.h"
+#include "base/win/scoped_handle.h"
+
+namespace agent {
+namespace common {
+
+// Invokes a callback on a thread of the system thread pool whenever a timer
+// fires or a named auto-reset event is signalled. Using the thread pool rather
+// than a thread of our own lets the trigger be stopped from DllMain, as no
+// thread has to exit for it.
+class SnapshotTrigger {
+ public:
+  SnapshotTrigger();
+  ~SnapshotTrigger();
+
+  // Starts invoking @p callback.
+  // @param event_name The name of the auto-reset event that triggers the
+  //     callback when signalled. May be empty.
+  // @param interval The interval at which the callback is periodically
+  //     invoked. The period restarts whenever the event is signalled. May be
+  //     zero.
+  // @param callback The callback to invoke. This may be invoked from several
+  //     threads at once.
+  // @returns true on success, false on failure or if there is neither an
+  //     event nor an interval.
+  bool Start(const std::wstring& event_name,
+             base::TimeDelta interval,
+             const base::Closure& callback);
+
+  // Starts invoking @p callback as configured by the
+  // kIndexedFrequencySnapshotEventEnvVar and
+  // kIndexedFrequencySnapshotIntervalEnvVar environment variables.
+  // @param callback The callback to invoke.
+  // @returns true on success, including if neither variable is set, in which
+  //     case the trigger isn't started. Returns false on failure.
+  bool StartFromEnvironment(const base::Closure& callback);
+
+  // Stops invoking the callback, waiting for the invocations in progress to
+  // complete. This is a no-op if the trigger isn't started.
+  void Stop();
+
+  // @returns true if the trigger is started.
+  bool started() const { return wait_handle_ != NULL; }
+
+ private:
+  // The thread pool callback.
+  static void CALLBACK OnWaitCompleted(void* context, BOOLEAN timer_fired);
+
+  // The event being waited on. It is unnamed, and never signalled, when only
+  // the interval is given.
+  base::win::ScopedHandle event_;
+
+  // The registered wait, or NULL if the trigger isn't started.
+  HANDLE wait_handle_;
+
+  // The callback to invoke.
+  base::Closure callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(SnapshotTrigger);
+};
+
+}  // namespace common
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_COMMON_SNAPSHOT_TRIGGER_H_
@@ -0,0 +1,130 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/common/snapshot_trigger.h"
+
+#include <memory>
+
+#include "base/bind.h"
+#include "base/environment.h"
+#include "base/strings/stringprintf.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/test/test_timeouts.h"
+#include "base/win/scoped_handle.h"
+#include "gtest/gtest.h"
+#include "syzygy/common/indexed_frequency_data.h"
+
+namespace agent {
+namespace common {
+
+namespace {
+
+class SnapshotTriggerTest : public testing::Test {
+ public:
+  SnapshotTriggerTest() : snapshot_taken_(false, false) {
+  }
+
+  void TearDown() override {
+    std::unique_ptr<base::Environment> env(base::Environment::Create());
+    env->UnSetVar(::common::kIndexedFrequencySnapshotEventEnvVar);
+    env->UnSetVar(::common::kIndexedFrequencySnapshotIntervalEnvVar);
+  }
+
+  base::Closure GetCallback() {
+    return base::Bind(&base::WaitableEvent::Signal,
+                      base::Unretained(&snapshot_taken_));
+  }
+
+  // @returns a name for the snapshot event that no other test uses.
+  static std::wstring GetUniqueEventName() {
+    return base::StringPrintf(L"syzygy-snapshot-trigger-test-%u-%u",
+                              ::GetCurrentProcessId(), ::GetTickCount());
+  }
+
+  // Signals the snapshot event @p name.
+  static void SignalEvent(const std::wstring& name) {
+    base::win::ScopedHandle event(
+        ::OpenEvent(EVENT_MODIFY_STATE, FALSE, name.c_str()));
+    ASSERT_TRUE(event.IsValid());
+    ASSERT_TRUE(::SetEvent(event.Get()));
+  }
+
+  base::WaitableEvent snapshot_taken_;
+};
+
+}  // namespace
+
+TEST_F(SnapshotTriggerTest, StartFailsWithoutEventOrInterval) {
+  SnapshotTrigger trigger;
+  EXPECT_FALSE(trigger.Start(L"", base::TimeDelta(), GetCallback()));
+  EXPECT_FALSE(trigger.started());
+
+  // Stopping a trigger that isn't started is fine.
+  trigger.Stop();
+}
+
+TEST_F(SnapshotTriggerTest, EventTriggersCallback) {
+  std::wstring name = GetUniqueEventName();
+  SnapshotTrigger trigger;
+  ASSERT_TRUE(trigger.Start(name, base::TimeDelta(), GetCallback()));
+  EXPECT_TRUE(trigger.started());
+
+  ASSERT_NO_FATAL_FAILURE(SignalEvent(name));
+  EXPECT_TRUE(snapshot_taken_.TimedWait(TestTimeouts::action_timeout()));
+
+  // Once stopped, the event no longer triggers the callback.
+  trigger.Stop();
+  EXPECT_FALSE(trigger.started());
+  EXPECT_EQ(NULL, ::OpenEvent(EVENT_MODIFY_STATE, FALSE, name.c_str()));
+}
+
+TEST_F(SnapshotTriggerTest, IntervalTriggersCallback) {
+  SnapshotTrigger trigger;
+  ASSERT_TRUE(trigger.Start(L"", base::TimeDelta::FromMilliseconds(1),
+                            GetCallback()));
+
+  // The callback is invoked repeatedly.
+  EXPECT_TRUE(snapshot_taken_.TimedWait(TestTimeouts::action_timeout()));
+  EXPECT_TRUE(snapshot_taken_.TimedWait(TestTimeouts::action_timeout()));
+}
+
+TEST_F(SnapshotTriggerTest, StartFromEnvironment) {
+  // Without configuration, the trigger isn't started.
+  SnapshotTrigger trigger;
+  EXPECT_TRUE(trigger.StartFromEnvironment(GetCallback()));
+  EXPECT_FALSE(trigger.started());
+
+  // An invalid interval is an error.
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_TRUE(env->SetVar(::common::kIndexedFrequencySnapshotIntervalEnvVar,
+                          "soon"));
+  EXPECT_FALSE(trigger.StartFromEnvironment(GetCallback()));
+  EXPECT_FALSE(trigger.started());
+  ASSERT_TRUE(
+      env->UnSetVar(::common::kIndexedFrequencySnapshotIntervalEnvVar));
+
+  // The event name is derived from the base name and the process ID.
+  ASSERT_TRUE(env->SetVar(::common::kIndexedFrequencySnapshotEventEnvVar,
+                          "syzygy-snapshot-trigger-test"));
+  ASSERT_TRUE(trigger.StartFromEnvironment(GetCallback()));
+  EXPECT_TRUE(trigger.started());
+
+  ASSERT_NO_FATAL_FAILURE(SignalEvent(
+      ::common::GetIndexedFrequencySnapshotEventName(
+          L"syzygy-snapshot-trigger-test", ::GetCurrentProcessId())));
+  EXPECT_TRUE(snapshot_taken_.TimedWait(TestTimeouts::action_timeout()));
+}
+
+}  // namespace common
+}  // namespace agent
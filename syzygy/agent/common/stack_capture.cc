@@ -17,6 +17,7 @@
 #include <algorithm>
 
 #include "base/logging.h"
+#include "syzygy/agent/common/module_bounds_cache.h"
 #include "syzygy/agent/common/stack_walker.h"
 #include "syzygy/core/address_space.h"
 
@@ -30,6 +31,9 @@ namespace common {
 size_t StackCapture::bottom_frames_to_skip_ =
     ::common::kDefaultBottomFramesToSkip;
 
+// The cache used to find the modules containing the frames.
+const ModuleBoundsCache* StackCapture::module_bounds_cache_ = nullptr;
+
 size_t StackCapture::GetSize(size_t max_num_frames) {
   DCHECK_LT(0u, max_num_frames);
   max_num_frames = std::min(max_num_frames, kMaxNumFrames);
@@ -123,18 +127,21 @@ namespace {
 using FalseModuleSpace = core::AddressSpace<uintptr_t, uintptr_t, const char*>;
 FalseModuleSpace false_module_space;
 
-// Returns an untracked handle to the module containing the given address, if
-// there is one. Returns nullptr if no module is found. If false modules have
-// been injected via the testing seam, will first check those.
-HMODULE GetModuleFromAddress(void* address) {
-  // Try the false module space first.
-  if (!false_module_space.empty()) {
-    FalseModuleSpace::Range range(reinterpret_cast<uintptr_t>(address), 1);
-    auto it = false_module_space.FindContaining(range);
-    if (it != false_module_space.end())
-      return reinterpret_cast<HMODULE>(it->first.start());
-  }
+// Returns the false module containing the given address, if there is one.
+// Returns nullptr otherwise.
+HMODULE GetFalseModuleFromAddress(void* address) {
+  if (false_module_space.empty())
+    return nullptr;
+  FalseModuleSpace::Range range(reinterpret_cast<uintptr_t>(address), 1);
+  auto it = false_module_space.FindContaining(range);
+  if (it == false_module_space.end())
+    return nullptr;
+  return reinterpret_cast<HMODULE>(it->first.start());
+}
 
+// Returns an untracked handle to the module containing the given address, if
+// there is one. Returns nullptr if no module is found.
+HMODULE GetOSModuleFromAddress(void* address) {
   // Query the OS for any loaded modules that house the given address.
   HMODULE instance = nullptr;
   if (!::GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
@@ -178,6 +185,25 @@ void StackCapture::ComputeRelativeStackId() const {
   DCHECK(asan_handle != NULL);
   DCHECK(!relative_stack_id_);
 
+  // Find the modules containing the frames. When available the module cache
+  // is used to look them all up at once, otherwise the OS is queried for each
+  // of them. The false modules injected via the testing seam take precedence.
+  HMODULE modules[kMaxNumFrames] = {};
+  if (module_bounds_cache_ != nullptr) {
+    module_bounds_cache_->GetModulesFromAddresses(frames_, num_frames_,
+                                                  modules);
+  }
+  for (size_t i = 0; i < num_frames_; ++i) {
+    if (frames_[i] == nullptr)
+      continue;
+    HMODULE false_module = GetFalseModuleFromAddress(frames_[i]);
+    if (false_module != nullptr) {
+      modules[i] = false_module;
+    } else if (module_bounds_cache_ == nullptr) {
+      modules[i] = GetOSModuleFromAddress(frames_[i]);
+    }
+  }
+
   relative_stack_id_ = StartStackId();
   for (size_t i = 0; i < num_frames_; ++i) {
     // NULL stack frames may be returned from ::CaptureStackBackTrace.
@@ -188,7 +214,7 @@ void StackCapture::ComputeRelativeStackId() const {
     // Entirely skip frames that lie inside this module. This allows the
     // relative stack ID to be stable across different versions of the RTL
     // even if stack depth/layout changes.
-    HMODULE module = GetModuleFromAddress(frames_[i]);
+    HMODULE module = modules[i];
     if (module == asan_handle)
       continue;
 
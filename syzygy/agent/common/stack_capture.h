@@ -27,6 +27,9 @@
 namespace agent {
 namespace common {
 
+// Forward declaration.
+class ModuleBoundsCache;
+
 // A simple class for holding a stack trace capture.
 class StackCapture {
  public:
@@ -131,6 +134,21 @@ class StackCapture {
   // Get the number of bottom frames to skip per stack trace.
   static size_t bottom_frames_to_skip() { return bottom_frames_to_skip_; }
 
+  // Sets the cache used to find the modules containing the frames when
+  // computing the relative stack IDs. Without it the OS is queried for each
+  // frame, which takes the loader lock.
+  // @param module_bounds_cache The cache to use, or nullptr to query the OS.
+  //     This must outlive any use of the stack captures.
+  static void set_module_bounds_cache(
+      const ModuleBoundsCache* module_bounds_cache) {
+    module_bounds_cache_ = module_bounds_cache;
+  }
+
+  // @returns the cache used to find the modules containing the frames.
+  static const ModuleBoundsCache* module_bounds_cache() {
+    return module_bounds_cache_;
+  }
+
   // Initializes a stack trace from an array of frame pointers and a count.
   // @param frames an array of frame pointers.
   // @param num_frames the number of valid frame pointers in @frames. Note
@@ -174,6 +192,9 @@ class StackCapture {
   // The number of bottom frames to skip on the stack traces.
   static size_t bottom_frames_to_skip_;
 
+  // The cache used to find the modules containing the frames, if any.
+  static const ModuleBoundsCache* module_bounds_cache_;
+
   // The absolute unique ID of this hash. This is used for storing the hash in
   // the set.
   StackId absolute_stack_id_;
@@ -17,6 +17,7 @@
 #include <memory>
 
 #include "gtest/gtest.h"
+#include "syzygy/agent/common/module_bounds_cache.h"
 #include "testing/gmock/include/gmock/gmock.h"
 
 namespace agent {
@@ -148,5 +149,22 @@ TEST_F(StackCaptureTest, RelativeStackId) {
   EXPECT_EQ(123456U, test_stack_capture.relative_stack_id());
 }
 
+TEST_F(StackCaptureTest, RelativeStackIdWithModuleBoundsCache) {
+  StackCapture stack_capture;
+  stack_capture.InitFromStack();
+  ASSERT_TRUE(stack_capture.IsValid());
+  StackId relative_stack_id = stack_capture.relative_stack_id();
+
+  // Looking up the modules in the cache rather than via the OS yields the
+  // same ID.
+  ModuleBoundsCache module_bounds_cache;
+  ASSERT_TRUE(module_bounds_cache.Init());
+  StackCapture::set_module_bounds_cache(&module_bounds_cache);
+  StackCapture stack_capture_copy;
+  stack_capture_copy.InitFromExistingStack(stack_capture);
+  EXPECT_EQ(relative_stack_id, stack_capture_copy.relative_stack_id());
+  StackCapture::set_module_bounds_cache(nullptr);
+}
+
 }  // namespace common
 }  // namespace agent
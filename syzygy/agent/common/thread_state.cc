@@ -16,12 +16,18 @@
 
 #include "syzygy/agent/common/thread_state.h"
 
+#include <algorithm>
+
 namespace agent {
 namespace common {
 
+const size_t ThreadStateManager::kScavengeBatchSize;
+
 ThreadStateBase::ThreadStateBase()
     : thread_handle_(
-        ::OpenThread(SYNCHRONIZE, FALSE, ::GetCurrentThreadId())) {
+        ::OpenThread(SYNCHRONIZE, FALSE, ::GetCurrentThreadId())),
+      next_pending_(NULL),
+      marked_for_death_(false) {
   DCHECK(thread_handle_.IsValid());
   InitializeListHead(&entry_);
 }
@@ -30,7 +36,10 @@ ThreadStateBase::~ThreadStateBase() {
   DCHECK(IsListEmpty(&entry_));
 }
 
-ThreadStateManager::ThreadStateManager() {
+ThreadStateManager::ThreadStateManager()
+    : death_row_size_(0),
+      scavenge_threshold_(kScavengeBatchSize),
+      pending_items_(NULL) {
   InitializeListHead(&active_items_);
   InitializeListHead(&death_row_items_);
 }
@@ -71,13 +80,30 @@ ThreadStateManager::~ThreadStateManager() {
 void ThreadStateManager::Register(ThreadStateBase* item) {
   DCHECK(item != NULL);
   DCHECK(IsListEmpty(&item->entry_));
-  base::AutoLock auto_lock(lock_);
-  InsertTailList(&active_items_, &item->entry_);
+  DCHECK(item->next_pending_ == NULL);
+
+  // The stack is only ever drained whole, so there's no ABA problem here.
+  ThreadStateBase* head = pending_items_;
+  while (true) {
+    item->next_pending_ = head;
+    ThreadStateBase* previous = static_cast<ThreadStateBase*>(
+        ::InterlockedCompareExchangePointer(
+            reinterpret_cast<PVOID volatile*>(&pending_items_), item, head));
+    if (previous == head)
+      break;
+    head = previous;
+  }
 }
 
 void ThreadStateManager::Unregister(ThreadStateBase* item) {
   DCHECK(item != NULL);
   base::AutoLock auto_lock(lock_);
+  DrainPendingItemsUnlocked();
+  if (item->marked_for_death_) {
+    DCHECK_LT(0u, death_row_size_);
+    --death_row_size_;
+    item->marked_for_death_ = false;
+  }
   RemoveEntryList(&item->entry_);
   InitializeListHead(&item->entry_);
 }
@@ -85,28 +111,37 @@ void ThreadStateManager::Unregister(ThreadStateBase* item) {
 void ThreadStateManager::MarkForDeath(ThreadStateBase* item) {
   DCHECK(item != NULL);
 
+  // We'll store the list of scavenged items here.
+  LIST_ENTRY dead_items;
+  InitializeListHead(&dead_items);
+
   {
     base::AutoLock auto_lock(lock_);
+    DrainPendingItemsUnlocked();
 
     // Make sure the item we're marking is on the active or death row lists.
     DCHECK(IsNodeOnList(&active_items_, &item->entry_) ||
            IsNodeOnList(&death_row_items_, &item->entry_));
 
-    // Pull it out of the list it's on, this'll preserve it over the scavenge
-    // below, in the unlikely case that the item is being marked from another
-    // thread than it's own.
+    // Mark item for death, for later scavenging. An item that is marked again
+    // is already counted.
     RemoveEntryList(&item->entry_);
-  }
-
-  // Use this opportunity to scavenge existing thread states on death row.
-  Scavenge();
-
-  // Mark item for death, for later scavenging.
-  {
-    base::AutoLock auto_lock(lock_);
-
     InsertHeadList(&death_row_items_, &item->entry_);
+    if (!item->marked_for_death_) {
+      item->marked_for_death_ = true;
+      ++death_row_size_;
+    }
+
+    // Scavenging walks the whole of death row, so it's only done once enough
+    // items have been added to it since the last time. This keeps the cost of
+    // a thread detach constant, however many threads are yet to terminate.
+    if (death_row_size_ >= scavenge_threshold_)
+      GatherDeadItemsUnlocked(&dead_items);
   }
+
+  // We can delete any dead items we found outside of the lock.
+  DeleteItems(&dead_items);
+  DCHECK(IsListEmpty(&dead_items));
 }
 
 bool ThreadStateManager::Scavenge() {
@@ -118,6 +153,7 @@ bool ThreadStateManager::Scavenge() {
   // Acquire the lock when interacting with the internal data.
   {
     base::AutoLock auto_lock(lock_);
+    DrainPendingItemsUnlocked();
 
     // Put all of the death row items belonging
     // to dead threads into dead_items.
@@ -142,8 +178,10 @@ void ThreadStateManager::GatherDeadItemsUnlocked(LIST_ENTRY* dead_items) {
   lock_.AssertAcquired();
 
   // Return if the death row items list is empty.
-  if (IsListEmpty(&death_row_items_))
+  if (IsListEmpty(&death_row_items_)) {
+    scavenge_threshold_ = kScavengeBatchSize;
     return;
+  }
 
   // Walk the death row items list, looking for items owned by dead threads.
   ThreadStateBase* item =
@@ -159,10 +197,33 @@ void ThreadStateManager::GatherDeadItemsUnlocked(LIST_ENTRY* dead_items) {
     if (IsThreadDead(item)) {
       RemoveEntryList(&item->entry_);
       InsertTailList(dead_items, &item->entry_);
+      item->marked_for_death_ = false;
+      DCHECK_LT(0u, death_row_size_);
+      --death_row_size_;
     }
 
     item = next_item;
   }
+
+  // The items that survived are only looked at again once as many new ones
+  // have joined them, so that a scavenge costs amortized constant time per
+  // item marked for death.
+  scavenge_threshold_ =
+      death_row_size_ + std::max(kScavengeBatchSize, death_row_size_);
+}
+
+void ThreadStateManager::DrainPendingItemsUnlocked() {
+  lock_.AssertAcquired();
+
+  ThreadStateBase* item = static_cast<ThreadStateBase*>(
+      ::InterlockedExchangePointer(
+          reinterpret_cast<PVOID volatile*>(&pending_items_), NULL));
+  while (item != NULL) {
+    ThreadStateBase* next_item = item->next_pending_;
+    item->next_pending_ = NULL;
+    InsertHeadList(&active_items_, &item->entry_);
+    item = next_item;
+  }
 }
 
 bool ThreadStateManager::IsThreadDead(ThreadStateBase* item) {
@@ -15,6 +15,10 @@
 // Defines the ThreadStateBase and ThreadStateManager classes, which assists in
 // tracking and properly scavenging thread local resources owned by an agent
 // DLL as threads attach and detach from instrumented modules.
+//
+// Registering a thread state is lock-free, as every new thread registers one
+// from its first instrumented call. The state of the threads that detached
+// is freed in batches, so that the death row isn't scanned on every detach.
 
 #ifndef SYZYGY_AGENT_COMMON_THREAD_STATE_H_
 #define SYZYGY_AGENT_COMMON_THREAD_STATE_H_
@@ -48,6 +52,13 @@ class ThreadStateBase {
   // The entry linking us into the manager's active_items_ or death_row_ lists.
   LIST_ENTRY entry_;
 
+  // Links us into the manager's pending_items_ stack until we're moved to its
+  // active_items_ list.
+  ThreadStateBase* next_pending_;
+
+  // True while we're on the manager's death_row_items_ list.
+  bool marked_for_death_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(ThreadStateBase);
 };
@@ -61,7 +72,10 @@ class ThreadStateManager {
   // Destroys a ThreadStateManager instance.
   ~ThreadStateManager();
 
-  // Insert @p item into the list of active items.
+  // The minimum number of items on death row before they're scavenged.
+  static const size_t kScavengeBatchSize = 16;
+
+  // Insert @p item into the list of active items. This is lock-free.
   void Register(ThreadStateBase* item);
 
   // Forcibly removes a thread state @p item from the active or death-row list,
@@ -70,7 +84,9 @@ class ThreadStateManager {
 
   // Transfer @p item from the list of active items to the death row list. This
   // does not delete @p item immediately if it's called on @p items' own
-  // thread.
+  // thread. The items of dead threads are deleted in batches, once death row
+  // has grown by at least kScavengeBatchSize items since it was last
+  // scavenged.
   void MarkForDeath(ThreadStateBase* item);
 
  protected:
@@ -84,6 +100,10 @@ class ThreadStateManager {
   // deleted using the Delete() method.
   void GatherDeadItemsUnlocked(LIST_ENTRY* dead_items);
 
+  // Moves the items registered since the last call to the list of active
+  // items. This must be called under lock_ before walking active_items_.
+  void DrainPendingItemsUnlocked();
+
   // Deletes (using the delete operator) each item in @p items.
   static void DeleteItems(LIST_ENTRY* items);
 
@@ -101,6 +121,16 @@ class ThreadStateManager {
   // death. Accessed under lock_.
   LIST_ENTRY death_row_items_;
 
+  // The number of items in death_row_items_, and the number at which it's
+  // next scavenged. Accessed under lock_.
+  size_t death_row_size_;
+  size_t scavenge_threshold_;
+
+  // A stack of the items registered since active_items_ was last updated,
+  // linked by their next_pending_ fields. Pushed to without the lock, and
+  // drained whole under lock_.
+  ThreadStateBase* volatile pending_items_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(ThreadStateManager);
 };
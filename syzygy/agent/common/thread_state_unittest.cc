@@ -51,6 +51,7 @@ class TestThreadStateManager : public ThreadStateManager {
   // Returns true if the there are no active thread state items being managed.
   bool HasActiveItems() {
     base::AutoLock auto_lock(lock_);
+    DrainPendingItemsUnlocked();
     return !IsListEmpty(&active_items_);
   }
 
@@ -65,6 +66,7 @@ class TestThreadStateManager : public ThreadStateManager {
   // Returns true iff @p item is in the active items list.
   bool IsActive(const TestThreadState* item) {
     base::AutoLock auto_lock(lock_);
+    DrainPendingItemsUnlocked();
     return ListContains(&active_items_, item);
   }
 
@@ -236,6 +238,34 @@ TEST_F(ThreadStateTest, LifeCycle) {
   EXPECT_TRUE(base::AtomicRefCountIsZero(&thread_states_));
 }
 
+TEST_F(ThreadStateTest, ScavengesInBatches) {
+  // Mark one less item than a batch for death, then let their thread die.
+  const size_t kNumItems = ThreadStateManager::kScavengeBatchSize - 1;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    TestThreadState* thread_state = NULL;
+    ASSERT_NO_FATAL_FAILURE(CreateThreadState(&thread_state));
+    ASSERT_NO_FATAL_FAILURE(RegisterThreadState(thread_state));
+    ASSERT_NO_FATAL_FAILURE(MarkThreadStateForDeath(thread_state));
+  }
+  worker_thread_.Stop();
+
+  // The dead items are kept until the batch is complete.
+  EXPECT_EQ(kNumItems, static_cast<size_t>(thread_states_));
+  EXPECT_TRUE(manager_->HasDeathRowItems());
+
+  // Completing the batch from a live thread frees the dead items, but not
+  // the live one.
+  TestThreadState* thread_state = NULL;
+  ASSERT_NO_FATAL_FAILURE(CreateThreadStateImpl(&thread_state));
+  manager_->Register(thread_state);
+  manager_->MarkForDeath(thread_state);
+  EXPECT_TRUE(base::AtomicRefCountIsOne(&thread_states_));
+  EXPECT_TRUE(manager_->IsOnDeathRow(thread_state));
+
+  manager_.reset();
+  EXPECT_TRUE(base::AtomicRefCountIsZero(&thread_states_));
+}
+
 TEST_F(ThreadStateTest, DeletesAllThreadStatesOnDestruction) {
   TestThreadState* thread_state = NULL;
   ASSERT_NO_FATAL_FAILURE(CreateThreadState(&thread_state));
@@ -15,9 +15,13 @@
 // Implementation of the code coverage DLL.
 #include "syzygy/agent/coverage/coverage.h"
 
+#include <intrin.h>
+#include <stddef.h>
+
 #include <memory>
 
 #include "base/at_exit.h"
+#include "base/bind.h"
 #include "base/command_line.h"
 #include "base/environment.h"
 #include "base/lazy_instance.h"
@@ -125,11 +129,49 @@ Coverage* Coverage::Instance() {
   return static_coverage_instance.Pointer();
 }
 
-Coverage::Coverage() {
-  trace::client::InitializeRpcSession(&session_, &segment_);
+Coverage::Coverage() : shared_header_(NULL) {
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  std::string shared_memory_name;
+  if (env->GetVar(::common::kCoverageSharedMemoryEnvVar,
+                  &shared_memory_name)) {
+    if (!InitializeSharedMemory(base::UTF8ToWide(shared_memory_name)))
+      LOG(ERROR) << "Unable to initialize the coverage shared memory.";
+  } else {
+    trace::client::InitializeRpcSession(&session_, &segment_);
+
+    // Readers of the shared memory see the coverage live, snapshots are only
+    // needed for the trace file.
+    if (!session_.IsDisabled() &&
+        !snapshot_trigger_.StartFromEnvironment(base::Bind(
+            &Coverage::TakeSnapshot, base::Unretained(this)))) {
+      LOG(ERROR) << "Failed to start the coverage snapshots.";
+    }
+  }
+
+  // Without notifications the static coverage arrays are still flushed at
+  // tear-down, but those of the modules unloaded earlier are lost.
+  if (!watcher_.Init(base::Bind(&Coverage::OnDllNotification,
+                                base::Unretained(this)))) {
+    LOG(WARNING) << "Unable to watch for module unloads.";
+  }
 }
 
 Coverage::~Coverage() {
+  snapshot_trigger_.Stop();
+  watcher_.Reset();
+
+  // The remaining modules are still mapped, flush them while the session is
+  // still alive.
+  base::AutoLock auto_lock(lock_);
+  for (const auto& module : modules_)
+    FlushStaticCoverageData(module.second);
+  modules_.clear();
+
+  // The section outlives our view of it for as long as readers hold it open.
+  if (shared_header_ != NULL) {
+    ::UnmapViewOfFile(shared_header_);
+    shared_header_ = NULL;
+  }
 }
 
 void WINAPI Coverage::EntryHook(EntryHookFrame* entry_frame) {
@@ -158,6 +200,18 @@ void WINAPI Coverage::EntryHook(EntryHookFrame* entry_frame) {
   Coverage* coverage = Coverage::Instance();
   DCHECK(coverage != NULL);
 
+  // Shared-memory coverage needs neither the call trace service nor module
+  // events, as the section describes the modules itself.
+  if (coverage->shared_header_ != NULL) {
+    if (!coverage->InitializeCoverageData(module_base,
+                                          entry_frame->coverage_data)) {
+      LOG(ERROR) << "Failed to initialize coverage data.";
+      return;
+    }
+    LOG(INFO) << "Coverage client initialized with shared memory.";
+    return;
+  }
+
   // If the call trace client is not running we simply abort. This is not an
   // error, however, as the instrumented module can still run.
   if (!coverage->session_.IsTracing()) {
@@ -214,6 +268,79 @@ bool Coverage::InitializeCoverageData(void* module_base,
     return true;
   }
 
+  uint8_t* data = NULL;
+  if (shared_header_ != NULL) {
+    data = AllocateSharedCoverageData(module_base, coverage_data);
+  } else {
+    data = AllocateTraceFileCoverageData(module_base, coverage_data);
+  }
+  if (data == NULL)
+    return false;
+
+  // Remember the static array, as inline bitmap instrumentation keeps writing
+  // to it, and it may also have seen visits before this initialization.
+  ModuleCoverageData module_data = {
+      static_cast<uint8_t*>(coverage_data->frequency_data),
+      data,
+      coverage_data->num_entries };
+  {
+    base::AutoLock auto_lock(lock_);
+    modules_[reinterpret_cast<HMODULE>(module_base)] = module_data;
+  }
+
+  // Hook up the newly allocated buffer to the call-trace instrumentation.
+  coverage_data->frequency_data = data;
+
+  return true;
+}
+
+bool Coverage::InitializeSharedMemory(const std::wstring& name) {
+  DCHECK(!name.empty());
+  DCHECK(shared_header_ == NULL);
+
+  shared_memory_.Set(::CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+                                         PAGE_READWRITE, 0,
+                                         ::common::kCoverageSharedMemorySize,
+                                         name.c_str()));
+  if (!shared_memory_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create coverage shared memory \"" << name
+               << "\": " << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  void* view = ::MapViewOfFile(shared_memory_.Get(), FILE_MAP_WRITE, 0, 0,
+                               ::common::kCoverageSharedMemorySize);
+  if (view == NULL) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to map coverage shared memory: "
+               << ::common::LogWe(error) << ".";
+    shared_memory_.Close();
+    return false;
+  }
+
+  // A section that already existed is reset, as it may be left over from a
+  // previous run of this process.
+  shared_header_ = reinterpret_cast<::common::CoverageSharedMemoryHeader*>(
+      view);
+  ::memset(shared_header_, 0, sizeof(*shared_header_));
+  shared_header_->version = ::common::kCoverageSharedMemoryVersion;
+  shared_header_->size = ::common::kCoverageSharedMemorySize;
+  shared_header_->process_id = ::GetCurrentProcessId();
+  shared_header_->data_end_offset = sizeof(*shared_header_);
+
+  // Publish the signature last, so that readers never see a header that is
+  // only partly initialized.
+  ::MemoryBarrier();
+  shared_header_->signature = ::common::kCoverageSharedMemorySignature;
+
+  return true;
+}
+
+uint8_t* Coverage::AllocateTraceFileCoverageData(
+    void* module_base, const IndexedFrequencyData* coverage_data) {
+  DCHECK(coverage_data != NULL);
+
   // Determine the size of the basic block frequency struct.
   size_t bb_freq_size = sizeof(TraceIndexedFrequencyData) +
       coverage_data->num_entries * coverage_data->frequency_size - 1;
@@ -226,14 +353,14 @@ bool Coverage::InitializeCoverageData(void* module_base,
   trace::client::TraceFileSegment coverage_segment;
   if (!session_.AllocateBuffer(segment_size, &coverage_segment)) {
     LOG(ERROR) << "Failed to allocate coverage data segment.";
-    return false;
+    return NULL;
   }
 
   // Ensure it's big enough to allocation the basic-block frequency data
   // we want. This automatically accounts for the RecordPrefix overhead.
   if (!coverage_segment.CanAllocate(bb_freq_size)) {
     LOG(ERROR) << "Returned coverage data segment smaller than expected.";
-    return false;
+    return NULL;
   }
 
   // Allocate the basic-block frequency data. We will leave this allocated and
@@ -260,11 +387,139 @@ bool Coverage::InitializeCoverageData(void* module_base,
   trace_coverage_data->num_columns = 1;
   trace_coverage_data->num_entries = coverage_data->num_entries;
 
-  // Hook up the newly allocated buffer to the call-trace instrumentation.
-  coverage_data->frequency_data =
-      trace_coverage_data->frequency_data;
+  return trace_coverage_data->frequency_data;
+}
 
-  return true;
+uint8_t* Coverage::AllocateSharedCoverageData(
+    void* module_base, const IndexedFrequencyData* coverage_data) {
+  DCHECK(coverage_data != NULL);
+  DCHECK(shared_header_ != NULL);
+
+  // Modules are initialized under the loader lock, but this also serializes
+  // them against one another should that ever not be the case.
+  base::AutoLock auto_lock(lock_);
+
+  LONG index = shared_header_->num_modules;
+  if (index >= static_cast<LONG>(::common::kCoverageSharedMemoryMaxModules)) {
+    LOG(ERROR) << "Too many modules for the coverage shared memory.";
+    return NULL;
+  }
+
+  uint32_t data_offset = shared_header_->data_end_offset;
+  if (coverage_data->num_entries >
+          ::common::kCoverageSharedMemorySize - data_offset) {
+    LOG(ERROR) << "Coverage shared memory is too small for "
+               << coverage_data->num_entries << " basic blocks.";
+    return NULL;
+  }
+  shared_header_->data_end_offset += coverage_data->num_entries;
+
+  base::win::PEImage image(module_base);
+  const IMAGE_NT_HEADERS* nt_headers = image.GetNTHeaders();
+  ::common::CoverageSharedMemoryModule* module =
+      &shared_header_->modules[index];
+  module->module_base_addr = reinterpret_cast<uint32_t>(image.module());
+  module->module_base_size = nt_headers->OptionalHeader.SizeOfImage;
+  module->module_checksum = nt_headers->OptionalHeader.CheckSum;
+  module->module_time_date_stamp = nt_headers->FileHeader.TimeDateStamp;
+  module->data_offset = data_offset;
+  module->num_entries = coverage_data->num_entries;
+  if (::GetModuleFileName(image.module(), module->module_path,
+                          arraysize(module->module_path)) == 0) {
+    module->module_path[0] = L'\0';
+  }
+
+  // Publish the module once its entry is complete.
+  ::InterlockedIncrement(&shared_header_->num_modules);
+
+  return reinterpret_cast<uint8_t*>(shared_header_) + data_offset;
+}
+
+void Coverage::FlushStaticCoverageData(const ModuleCoverageData& data) {
+  DCHECK_NE(static_cast<uint8_t*>(nullptr), data.static_data);
+  DCHECK_NE(static_cast<uint8_t*>(nullptr), data.trace_data);
+
+  for (size_t i = 0; i < data.size; ++i)
+    data.trace_data[i] |= data.static_data[i];
+}
+
+void Coverage::TakeSnapshot() {
+  // Size the snapshot up front, so that the buffer isn't allocated under the
+  // lock.
+  size_t segment_size = 0;
+  {
+    base::AutoLock auto_lock(lock_);
+    for (const auto& module : modules_) {
+      segment_size += sizeof(RecordPrefix) +
+          sizeof(TraceIndexedFrequencyData) + module.second.size - 1;
+    }
+  }
+  if (segment_size == 0)
+    return;
+
+  trace::client::TraceFileSegment snapshot_segment;
+  if (!session_.AllocateBuffer(segment_size, &snapshot_segment)) {
+    LOG(ERROR) << "Failed to allocate coverage snapshot segment.";
+    return;
+  }
+
+  base::AutoLock auto_lock(lock_);
+  for (const auto& module : modules_) {
+    const ModuleCoverageData& data = module.second;
+    size_t record_size = sizeof(TraceIndexedFrequencyData) + data.size - 1;
+
+    // Modules initialized since the segment was sized are left for the next
+    // snapshot.
+    if (!snapshot_segment.CanAllocate(record_size))
+      break;
+
+    TraceIndexedFrequencyData* snapshot =
+        reinterpret_cast<TraceIndexedFrequencyData*>(
+            snapshot_segment.AllocateTraceRecordImpl(TRACE_INDEXED_FREQUENCY,
+                                                     record_size));
+    DCHECK(snapshot != NULL);
+
+    // The record of the module precedes its coverage array.
+    const size_t kHeaderSize = offsetof(TraceIndexedFrequencyData,
+                                        frequency_data);
+    ::memcpy(snapshot, data.trace_data - kHeaderSize, kHeaderSize);
+
+    // The instrumentation keeps writing to the arrays without a lock, so they
+    // are reset one atomic exchange at a time. A visit is thus either in this
+    // snapshot, or left for the next one.
+    for (size_t i = 0; i < data.size; ++i) {
+      uint8_t visited = 0;
+      if (data.trace_data[i] != 0) {
+        visited |= _InterlockedExchange8(
+            reinterpret_cast<char*>(&data.trace_data[i]), 0);
+      }
+      if (data.static_data[i] != 0) {
+        visited |= _InterlockedExchange8(
+            reinterpret_cast<char*>(&data.static_data[i]), 0);
+      }
+      snapshot->frequency_data[i] = visited;
+    }
+  }
+
+  if (!session_.ReturnBuffer(&snapshot_segment))
+    LOG(ERROR) << "Failed to return coverage snapshot segment.";
+}
+
+void Coverage::OnDllNotification(
+    agent::common::DllNotificationWatcher::EventType type,
+    HMODULE module,
+    size_t module_size,
+    const base::StringPiece16& dll_path,
+    const base::StringPiece16& dll_base_name) {
+  if (type != agent::common::DllNotificationWatcher::kDllUnloaded)
+    return;
+
+  base::AutoLock auto_lock(lock_);
+  ModuleCoverageDataMap::iterator it = modules_.find(module);
+  if (it == modules_.end())
+    return;
+  FlushStaticCoverageData(it->second);
+  modules_.erase(it);
 }
 
 }  // namespace coverage
@@ -17,17 +17,39 @@
 // instrumentation will dump its code coverage results. The instrumentation
 // injects a run-time dependency on this library and adds appropriate
 // initialization hooks.
+//
+// Instrumentation in inline bitmap mode keeps writing to the array statically
+// allocated in the image. Its contents are folded into the trace file when the
+// module is unloaded, or when this library is torn down.
+//
+// Long-running processes can have snapshots of their coverage shipped to the
+// trace file while they run, by setting the environment variables declared in
+// syzygy/common/indexed_frequency_data.h. Each snapshot holds the basic blocks
+// visited since the previous one.
+//
+// If the SYZYGY_COVERAGE_SHARED_MEMORY environment variable names a section,
+// the coverage arrays go to that shared-memory section instead, and no RPC
+// session is made. External processes may then read and reset the coverage
+// at any time. See syzygy/common/coverage_shared_memory.h for its layout.
 
 #ifndef SYZYGY_AGENT_COVERAGE_COVERAGE_H_
 #define SYZYGY_AGENT_COVERAGE_COVERAGE_H_
 
 #include <windows.h>
 #include <winnt.h>
+#include <map>
+#include <string>
 #include <vector>
 
 #include "base/lazy_instance.h"
+#include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
 #include "base/win/pe_image.h"
+#include "base/win/scoped_handle.h"
+#include "syzygy/agent/common/dll_notifications.h"
 #include "syzygy/agent/common/entry_frame.h"
+#include "syzygy/agent/common/snapshot_trigger.h"
+#include "syzygy/common/coverage_shared_memory.h"
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/trace/client/rpc_session.h"
 
@@ -61,10 +83,58 @@ class Coverage {
   Coverage();
   ~Coverage();
 
+  // The statically allocated coverage array of a module, and the trace file
+  // buffer it was redirected to.
+  struct ModuleCoverageData {
+    uint8_t* static_data;
+    uint8_t* trace_data;
+    size_t size;
+  };
+  typedef std::map<HMODULE, ModuleCoverageData> ModuleCoverageDataMap;
+
+  // Creates and maps the shared-memory section.
+  // @param name The name of the section.
+  // @returns true on success, false otherwise.
+  bool InitializeSharedMemory(const std::wstring& name);
+
   // Initializes the given coverage data element.
   bool InitializeCoverageData(void* module_base,
                               ::common::IndexedFrequencyData* coverage_data);
 
+  // Allocates the coverage array of a module in a trace file buffer.
+  // @param module_base The base address of the module.
+  // @param coverage_data The coverage data of the module.
+  // @returns the coverage array, or NULL on failure.
+  uint8_t* AllocateTraceFileCoverageData(
+      void* module_base,
+      const ::common::IndexedFrequencyData* coverage_data);
+
+  // Allocates the coverage array of a module in the shared-memory section.
+  // @param module_base The base address of the module.
+  // @param coverage_data The coverage data of the module.
+  // @returns the coverage array, or NULL on failure.
+  uint8_t* AllocateSharedCoverageData(
+      void* module_base,
+      const ::common::IndexedFrequencyData* coverage_data);
+
+  // Folds the visits recorded in the static coverage array of a module into
+  // its trace file buffer.
+  // @param data The coverage data of the module.
+  static void FlushStaticCoverageData(const ModuleCoverageData& data);
+
+  // Ships a copy of the coverage of the initialized modules to the call-trace
+  // service, and resets it. Visits recorded meanwhile are not lost, but go to
+  // either this snapshot or the next.
+  void TakeSnapshot();
+
+  // The DLL notification callback. Flushes the static coverage arrays of the
+  // modules being unloaded, while they are still mapped.
+  void OnDllNotification(agent::common::DllNotificationWatcher::EventType type,
+                         HMODULE module,
+                         size_t module_size,
+                         const base::StringPiece16& dll_path,
+                         const base::StringPiece16& dll_base_name);
+
   // The RPC session we're logging to/through.
   trace::client::RpcSession session_;
 
@@ -72,6 +142,24 @@ class Coverage {
   // goes to specially allocated segments that we don't explicitly keep track
   // of, but rather that we let live until the client gets torn down.
   trace::client::TraceFileSegment segment_;
+
+  // Watches for the modules being unloaded.
+  agent::common::DllNotificationWatcher watcher_;
+
+  // The shared-memory section and its mapped view, if coverage goes there
+  // rather than to the call trace service.
+  base::win::ScopedHandle shared_memory_;
+  ::common::CoverageSharedMemoryHeader* shared_header_;
+
+  // Protects modules_ and the allocations in the shared-memory section.
+  base::Lock lock_;
+
+  // The coverage data of the initialized modules, whose static coverage arrays
+  // have yet to be flushed. Under lock_.
+  ModuleCoverageDataMap modules_;
+
+  // Triggers the snapshots of the coverage, if they were asked for.
+  agent::common::SnapshotTrigger snapshot_trigger_;
 };
 
 }  // namespace coverage
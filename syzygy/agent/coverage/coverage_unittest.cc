@@ -16,11 +16,18 @@
 
 #include "syzygy/agent/coverage/coverage.h"
 
+#include <memory>
+
+#include "base/environment.h"
 #include "base/files/file_enumerator.h"
 #include "base/files/file_util.h"
 #include "base/files/scoped_temp_dir.h"
+#include "base/strings/stringprintf.h"
+#include "base/strings/utf_string_conversions.h"
+#include "base/win/scoped_handle.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/common/coverage_shared_memory.h"
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/trace/common/unittest_util.h"
 #include "syzygy/trace/parse/unittest_util.h"
@@ -261,5 +268,92 @@ TEST_F(CoverageClientTest, VisitOneBB) {
   ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
 }
 
+TEST_F(CoverageClientTest, VisitOneBBInStaticArray) {
+  ASSERT_NO_FATAL_FAILURE(StartService());
+  ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+  HMODULE self = ::GetModuleHandle(NULL);
+  DWORD process_id = ::GetCurrentProcessId();
+  DWORD thread_id = ::GetCurrentThreadId();
+
+  // Visit a block before the initialization, as a TLS callback would.
+  VisitBlock(0);
+
+  EXPECT_TRUE(DllMainThunk(self, DLL_PROCESS_ATTACH, NULL));
+  ASSERT_NE(static_cast<void*>(bb_seen_array), coverage_data.frequency_data);
+
+  // Inline bitmap instrumentation keeps writing to the static array.
+  bb_seen_array[1] = 1;
+
+  // Unload the DLL and stop the service. The static array is flushed to the
+  // trace file when the client is torn down.
+  ASSERT_NO_FATAL_FAILURE(UnloadDll());
+
+  const uint8_t kExpectedCoverageData[kBasicBlockCount] = {1, 1};
+
+  // Set up expectations for what should be in the trace.
+  EXPECT_CALL(handler_, OnProcessStarted(_, process_id, _));
+  EXPECT_CALL(handler_, OnProcessAttach(_,
+                                        process_id,
+                                        thread_id,
+                                        ModuleAtAddress(self)));
+  EXPECT_CALL(handler_, OnIndexedFrequency(
+      _,
+      process_id,
+      thread_id,
+      CoverageDataMatches(self, kBasicBlockCount, kExpectedCoverageData)));
+  EXPECT_CALL(handler_, OnProcessEnded(_, process_id));
+
+  // Replay the log.
+  ASSERT_NO_FATAL_FAILURE(ReplayLogs(1));
+}
+
+TEST_F(CoverageClientTest, VisitOneBBInSharedMemory) {
+  // No call trace service is needed.
+  std::string name = base::StringPrintf("syzygy-coverage-unittest-%d",
+                                        ::GetCurrentProcessId());
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_TRUE(env->SetVar(::common::kCoverageSharedMemoryEnvVar, name));
+  ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+  HMODULE self = ::GetModuleHandle(NULL);
+  EXPECT_TRUE(DllMainThunk(self, DLL_PROCESS_ATTACH, NULL));
+  ASSERT_NE(static_cast<void*>(bb_seen_array), coverage_data.frequency_data);
+
+  VisitBlock(0);
+
+  // The coverage can be read from another handle to the section while the
+  // client is running.
+  base::win::ScopedHandle section(::OpenFileMapping(
+      FILE_MAP_WRITE, FALSE, base::UTF8ToWide(name).c_str()));
+  ASSERT_TRUE(section.IsValid());
+  void* view = ::MapViewOfFile(section.Get(), FILE_MAP_WRITE, 0, 0, 0);
+  ASSERT_TRUE(view != NULL);
+  ::common::CoverageSharedMemoryHeader* header =
+      reinterpret_cast<::common::CoverageSharedMemoryHeader*>(view);
+  EXPECT_EQ(::common::kCoverageSharedMemorySignature, header->signature);
+  EXPECT_EQ(::common::kCoverageSharedMemoryVersion, header->version);
+  EXPECT_EQ(::GetCurrentProcessId(), header->process_id);
+  ASSERT_EQ(1, header->num_modules);
+
+  const ::common::CoverageSharedMemoryModule& module = header->modules[0];
+  EXPECT_EQ(reinterpret_cast<uint32_t>(self), module.module_base_addr);
+  ASSERT_EQ(kBasicBlockCount, module.num_entries);
+  uint8_t* data = static_cast<uint8_t*>(view) + module.data_offset;
+  EXPECT_EQ(coverage_data.frequency_data, data);
+  EXPECT_EQ(1, data[0]);
+  EXPECT_EQ(0, data[1]);
+
+  // Resetting the coverage is a matter of zeroing the array.
+  ::memset(data, 0, module.num_entries);
+  VisitBlock(1);
+  EXPECT_EQ(0, data[0]);
+  EXPECT_EQ(1, data[1]);
+
+  ASSERT_NO_FATAL_FAILURE(UnloadDll());
+  EXPECT_TRUE(::UnmapViewOfFile(view));
+  EXPECT_TRUE(env->UnSetVar(::common::kCoverageSharedMemoryEnvVar));
+}
+
 }  // namespace coverage
 }  // namespace agent
@@ -0,0 +1,113 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/memprof/concurrent_id_set.h"
+
+#include "base/logging.h"
+
+namespace agent {
+namespace memprof {
+
+namespace {
+
+using base::subtle::Acquire_CompareAndSwap;
+using base::subtle::Acquire_Load;
+using base::subtle::Atomic32;
+using base::subtle::NoBarrier_AtomicIncrement;
+using base::subtle::NoBarrier_Load;
+using base::subtle::Release_Store;
+
+static_assert((ConcurrentIdSet::kCapacity & (ConcurrentIdSet::kCapacity - 1))
+                  == 0,
+              "The capacity must be a power of two.");
+
+}  // namespace
+
+ConcurrentIdSet::ConcurrentIdSet()
+    : table_(new Atomic32[kCapacity]()),
+      has_zero_(0),
+      table_size_(0),
+      has_overflow_(0) {
+}
+
+bool ConcurrentIdSet::Insert(uint32_t id) {
+  if (id == 0)
+    return Acquire_CompareAndSwap(&has_zero_, 0, 1) == 0;
+
+  // Slots only ever go from empty to full, so once an ID is in its probe
+  // sequence it stays there, and an ID can only be stored past the slots
+  // that were full when it was looked for.
+  const Atomic32 value = static_cast<Atomic32>(id);
+  size_t slot = HashId(id);
+  for (size_t i = 0; i < kMaxProbes; ++i) {
+    Atomic32* entry = &table_[slot];
+    Atomic32 current = Acquire_Load(entry);
+    if (current == 0) {
+      current = Acquire_CompareAndSwap(entry, 0, value);
+      if (current == 0) {
+        NoBarrier_AtomicIncrement(&table_size_, 1);
+        return true;
+      }
+    }
+    if (current == value)
+      return false;
+    slot = (slot + 1) & (kCapacity - 1);
+  }
+
+  // The probe sequence is full, and stays that way, so every insertion of
+  // this ID ends up here.
+  base::AutoLock lock(lock_);
+  Release_Store(&has_overflow_, 1);
+  return overflow_.insert(id).second;
+}
+
+bool ConcurrentIdSet::Contains(uint32_t id) const {
+  if (id == 0)
+    return Acquire_Load(&has_zero_) != 0;
+
+  const Atomic32 value = static_cast<Atomic32>(id);
+  size_t slot = HashId(id);
+  for (size_t i = 0; i < kMaxProbes; ++i) {
+    Atomic32 current = Acquire_Load(&table_[slot]);
+    if (current == value)
+      return true;
+    if (current == 0)
+      return false;
+    slot = (slot + 1) & (kCapacity - 1);
+  }
+
+  if (Acquire_Load(&has_overflow_) == 0)
+    return false;
+  base::AutoLock lock(lock_);
+  return overflow_.find(id) != overflow_.end();
+}
+
+size_t ConcurrentIdSet::size() const {
+  size_t size = NoBarrier_Load(&table_size_) + NoBarrier_Load(&has_zero_);
+  base::AutoLock lock(lock_);
+  return size + overflow_.size();
+}
+
+// static
+size_t ConcurrentIdSet::HashId(uint32_t id) {
+  // Stack IDs are hashes already, but function IDs count up from 0, so mix
+  // the bits to spread runs of IDs across the table.
+  id ^= id >> 16;
+  id *= 0x85EBCA6B;
+  id ^= id >> 13;
+  return id & (kCapacity - 1);
+}
+
+}  // namespace memprof
+}  // namespace agent
@@ -0,0 +1,90 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a ConcurrentIdSet class. This is an insert-only set of 32-bit IDs
+// whose lookups and insertions are lock-free, for interning the IDs of
+// records that are emitted once, on first sight, from many threads at once.
+//
+// IDs live in an open-addressed table of fixed capacity, whose slots only
+// ever go from empty to holding an ID. An ID whose probe sequence is full
+// goes to an overflow set under a lock, so a table that fills up degrades
+// to locking rather than failing.
+
+#ifndef SYZYGY_AGENT_MEMPROF_CONCURRENT_ID_SET_H_
+#define SYZYGY_AGENT_MEMPROF_CONCURRENT_ID_SET_H_
+
+#include <memory>
+#include <set>
+
+#include "base/atomicops.h"
+#include "base/macros.h"
+#include "base/synchronization/lock.h"
+
+namespace agent {
+namespace memprof {
+
+class ConcurrentIdSet {
+ public:
+  // The number of slots of the table.
+  static const size_t kCapacity = 64 * 1024;
+
+  // The number of slots probed for an ID before it goes to the overflow set.
+  static const size_t kMaxProbes = 32;
+
+  ConcurrentIdSet();
+
+  // Inserts @p id in the set.
+  // @param id The ID to insert.
+  // @returns true if @p id was inserted, false if it was already present.
+  //     Exactly one of concurrent insertions of an ID returns true.
+  bool Insert(uint32_t id);
+
+  // @param id The ID to look for.
+  // @returns true if @p id is in the set.
+  bool Contains(uint32_t id) const;
+
+  // @returns the number of IDs in the set.
+  size_t size() const;
+
+ protected:
+  // @returns the first slot probed for @p id.
+  static size_t HashId(uint32_t id);
+
+  // The slots of the table, where 0 denotes an empty slot.
+  std::unique_ptr<base::subtle::Atomic32[]> table_;
+
+  // Non-zero if the ID 0, which can't be stored in the table, is present.
+  base::subtle::Atomic32 has_zero_;
+
+  // The number of IDs in the table.
+  base::subtle::Atomic32 table_size_;
+
+  // A lock that is used for synchronizing access to the overflow set.
+  mutable base::Lock lock_;
+
+  // The IDs that didn't fit the table.
+  std::set<uint32_t> overflow_;  // Under lock_.
+
+  // Non-zero once overflow_ isn't empty, so that lookups that miss the table
+  // only take the lock when needed.
+  base::subtle::Atomic32 has_overflow_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentIdSet);
+};
+
+}  // namespace memprof
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_MEMPROF_CONCURRENT_ID_SET_H_
@@ -0,0 +1,116 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/memprof/concurrent_id_set.h"
+
+#include <memory>
+#include <vector>
+
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace memprof {
+
+namespace {
+
+// Inserts a range of IDs, and counts those it inserted first.
+class InsertingThread : public base::SimpleThread {
+ public:
+  InsertingThread(ConcurrentIdSet* set, uint32_t num_ids)
+      : base::SimpleThread("InsertingThread"),
+        set_(set),
+        num_ids_(num_ids),
+        num_inserted_(0) {
+  }
+
+  void Run() override {
+    for (uint32_t id = 0; id < num_ids_; ++id) {
+      if (set_->Insert(id))
+        ++num_inserted_;
+    }
+  }
+
+  size_t num_inserted() const { return num_inserted_; }
+
+ private:
+  ConcurrentIdSet* set_;
+  uint32_t num_ids_;
+  size_t num_inserted_;
+};
+
+}  // namespace
+
+TEST(ConcurrentIdSetTest, InsertAndContains) {
+  ConcurrentIdSet set;
+  EXPECT_EQ(0u, set.size());
+  EXPECT_FALSE(set.Contains(0));
+  EXPECT_FALSE(set.Contains(42));
+
+  EXPECT_TRUE(set.Insert(42));
+  EXPECT_FALSE(set.Insert(42));
+  EXPECT_TRUE(set.Contains(42));
+  EXPECT_EQ(1u, set.size());
+
+  // Zero is a valid ID.
+  EXPECT_TRUE(set.Insert(0));
+  EXPECT_FALSE(set.Insert(0));
+  EXPECT_TRUE(set.Contains(0));
+  EXPECT_EQ(2u, set.size());
+
+  EXPECT_TRUE(set.Insert(0xFFFFFFFF));
+  EXPECT_TRUE(set.Contains(0xFFFFFFFF));
+  EXPECT_EQ(3u, set.size());
+}
+
+TEST(ConcurrentIdSetTest, Overflow) {
+  // Inserting more IDs than the table holds spills them to the overflow set.
+  ConcurrentIdSet set;
+  const uint32_t kNumIds = ConcurrentIdSet::kCapacity + 1000;
+  for (uint32_t id = 1; id <= kNumIds; ++id)
+    ASSERT_TRUE(set.Insert(id));
+  EXPECT_EQ(kNumIds, set.size());
+
+  for (uint32_t id = 1; id <= kNumIds; ++id) {
+    ASSERT_TRUE(set.Contains(id));
+    ASSERT_FALSE(set.Insert(id));
+  }
+  EXPECT_FALSE(set.Contains(kNumIds + 1));
+}
+
+TEST(ConcurrentIdSetTest, ConcurrentInsertions) {
+  ConcurrentIdSet set;
+  const uint32_t kNumIds = 10000;
+  const size_t kNumThreads = 4;
+
+  std::vector<std::unique_ptr<InsertingThread>> threads;
+  for (size_t i = 0; i < kNumThreads; ++i) {
+    threads.push_back(std::unique_ptr<InsertingThread>(
+        new InsertingThread(&set, kNumIds)));
+  }
+  for (auto& thread : threads)
+    thread->Start();
+
+  // Each ID is inserted first by exactly one thread.
+  size_t num_inserted = 0;
+  for (auto& thread : threads) {
+    thread->Join();
+    num_inserted += thread->num_inserted();
+  }
+  EXPECT_EQ(kNumIds, num_inserted);
+  EXPECT_EQ(kNumIds, set.size());
+}
+
+}  // namespace memprof
+}  // namespace agent
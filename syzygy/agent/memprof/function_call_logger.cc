@@ -24,6 +24,7 @@ FunctionCallLogger::FunctionCallLogger(
     : session_(session),
       stack_trace_tracking_(kTrackingNone),
       serialize_timestamps_(false),
+      compact_records_(false),
       call_counter_(0),
       serial_(0) {
   DCHECK_NE(static_cast<trace::client::RpcSession*>(nullptr), session);
@@ -82,12 +83,7 @@ uint32_t FunctionCallLogger::GetStackTraceId(TraceFileSegment* segment) {
 
   // Insert the stack ID. If it already exists it doesn't need to be emitted
   // so return early.
-  bool inserted = false;
-  {
-    base::AutoLock lock(lock_);
-    inserted = emitted_stack_ids_.insert(stack.absolute_stack_id()).second;
-  }
-  if (!inserted)
+  if (!emitted_stack_ids_.Insert(stack.absolute_stack_id()))
     return stack.absolute_stack_id();
 
   size_t frame_size = sizeof(void*) * stack.num_frames();
@@ -106,6 +102,57 @@ uint32_t FunctionCallLogger::GetStackTraceId(TraceFileSegment* segment) {
   return stack.absolute_stack_id();
 }
 
+uint8_t* FunctionCallLogger::AllocateCompactDetailedFunctionCall(
+    TraceFileSegment* segment,
+    uint32_t function_id,
+    uint32_t stack_trace_id,
+    size_t args_count,
+    const size_t* arg_sizes,
+    size_t args_data_size) {
+  DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+  DCHECK_NE(static_cast<const size_t*>(nullptr), arg_sizes);
+
+  // The call is stamped with the TSC just as its record prefix is, so that
+  // the timestamp encodes to a single byte unless they are serialized.
+  uint64_t tsc = ::trace::common::GetTsc();
+  uint64_t timestamp = serialize_timestamps_ ? GetCallTimestamp() : tsc;
+
+  // The arguments are at most 6, and arguments of size zero are absent.
+  uint8_t header[(4 + 6) * kMaxVarintLength];
+  size_t header_size = 0;
+  header_size += ::EncodeVarint(
+      ::ZigZagEncode(static_cast<int64_t>(timestamp - tsc)),
+      header + header_size);
+  header_size += ::EncodeVarint(function_id, header + header_size);
+  header_size += ::EncodeVarint(stack_trace_id, header + header_size);
+  header_size += ::EncodeVarint(args_count, header + header_size);
+  for (size_t i = 0; i < 6; ++i) {
+    if (arg_sizes[i] > 0)
+      header_size += ::EncodeVarint(arg_sizes[i], header + header_size);
+  }
+
+  size_t data_size = header_size + args_data_size;
+  if (!segment->CanAllocate(data_size) && !FlushSegment(segment))
+    return nullptr;
+  DCHECK(segment->CanAllocate(data_size));
+
+  TraceCompactDetailedFunctionCall* data =
+      segment->AllocateTraceRecord<TraceCompactDetailedFunctionCall>(
+          data_size);
+  trace::client::GetRecordPrefix(data)->timestamp = tsc;
+  ::memcpy(data->data, header, header_size);
+
+  return data->data + header_size;
+}
+
+uint64_t FunctionCallLogger::GetCallTimestamp() {
+  if (!serialize_timestamps_)
+    return ::trace::common::GetTsc();
+
+  base::AutoLock lock(lock_);
+  return call_counter_++;
+}
+
 bool FunctionCallLogger::FlushSegment(TraceFileSegment* segment) {
   DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
   return session_->ExchangeBuffer(segment);
@@ -18,8 +18,9 @@
 #ifndef SYZYGY_AGENT_MEMPROF_FUNCTION_CALL_LOGGER_H_
 #define SYZYGY_AGENT_MEMPROF_FUNCTION_CALL_LOGGER_H_
 
-#include <set>
+#include <map>
 
+#include "syzygy/agent/memprof/concurrent_id_set.h"
 #include "syzygy/agent/memprof/parameters.h"
 #include "syzygy/trace/client/rpc_session.h"
 
@@ -50,7 +51,8 @@ class FunctionCallLogger {
   // depends on the stack_trace_tracking mode. If disabled, this always
   // returns 0. If enabled, this returns the actual ID of the current stack.
   // If 'emit' mode is enabled, this will also keep track of already emitted
-  // stack IDs and emit the stack the first time it's encountered.
+  // stack IDs and emit the stack the first time it's encountered. Stacks that
+  // were already emitted are looked up without taking a lock.
   // @returns the ID of the current stack trace.
   uint32_t GetStackTraceId(TraceFileSegment* segment);
 
@@ -90,6 +92,10 @@ class FunctionCallLogger {
   void set_serialize_timestamps(bool serialize_timestamps) {
     serialize_timestamps_ = serialize_timestamps;
   }
+  bool compact_records() const { return compact_records_; }
+  void set_compact_records(bool compact_records) {
+    compact_records_ = compact_records;
+  }
   // @}
 
   // @returns a unique serial number for this function call logger.
@@ -100,12 +106,36 @@ class FunctionCallLogger {
   // Flushes the provided segment, and gets a new one.
   bool FlushSegment(TraceFileSegment* segment);
 
+  // Allocates a TraceCompactDetailedFunctionCall record and encodes all but
+  // the argument data in it.
+  // @param segment The segment to write to.
+  // @param function_id The ID of the function that was called.
+  // @param stack_trace_id The ID of the stack trace where the function was
+  //     called.
+  // @param args_count The number of arguments.
+  // @param arg_sizes The sizes of the arguments.
+  // @param args_data_size The total size of the arguments.
+  // @returns a pointer to where the argument data goes, or nullptr if the
+  //     record couldn't be allocated.
+  uint8_t* AllocateCompactDetailedFunctionCall(TraceFileSegment* segment,
+                                               uint32_t function_id,
+                                               uint32_t stack_trace_id,
+                                               size_t args_count,
+                                               const size_t* arg_sizes,
+                                               size_t args_data_size);
+
+  // Gets the timestamp of a function call.
+  uint64_t GetCallTimestamp();
+
   // The stack-trace tracking mode. Default to kTrackingNone.
   StackTraceTracking stack_trace_tracking_;
 
   // Whether or not timestamps are being serialized.
   bool serialize_timestamps_;
 
+  // Whether or not function calls are emitted in their compact encoding.
+  bool compact_records_;
+
   // The RPC session events are being written to.
   trace::client::RpcSession* session_;
 
@@ -122,9 +152,9 @@ class FunctionCallLogger {
   FunctionIdMap function_id_map_;  // Under lock_.
 
   // A set of stack traces whose IDs have already been emitted. This is only
-  // maintained if stack_trace_tracking_ is set to 'kTrackingEmit'.
-  typedef std::set<uint32_t> StackIdSet;
-  StackIdSet emitted_stack_ids_;  // Under lock_.
+  // maintained if stack_trace_tracking_ is set to 'kTrackingEmit'. This is
+  // lock-free, so that threads emitting known stacks don't contend.
+  ConcurrentIdSet emitted_stack_ids_;
 
   // A unique serial number generated at construction time. For unittesting.
   uint32_t serial_;
@@ -204,6 +234,28 @@ void FunctionCallLogger::EmitDetailedFunctionCall(TraceFileSegment* segment,
   args_count += arg_size5 > 0 ? 1 : 0;
   args_size += arg_size5;
 
+  if (compact_records_) {
+    const size_t arg_sizes[] = {
+        arg_size0, arg_size1, arg_size2, arg_size3, arg_size4, arg_size5 };
+    uint8_t* arg_data = AllocateCompactDetailedFunctionCall(
+        segment, function_id, stack_trace_id, args_count, arg_sizes,
+        args_size);
+    if (arg_data == nullptr)
+      return;
+    ArgumentSerializer<ArgType0>().serialize(arg0, arg_data);
+    arg_data += arg_size0;
+    ArgumentSerializer<ArgType1>().serialize(arg1, arg_data);
+    arg_data += arg_size1;
+    ArgumentSerializer<ArgType2>().serialize(arg2, arg_data);
+    arg_data += arg_size2;
+    ArgumentSerializer<ArgType3>().serialize(arg3, arg_data);
+    arg_data += arg_size3;
+    ArgumentSerializer<ArgType4>().serialize(arg4, arg_data);
+    arg_data += arg_size4;
+    ArgumentSerializer<ArgType5>().serialize(arg5, arg_data);
+    return;
+  }
+
   if (args_size > 0)
     args_size += (args_count + 1) * sizeof(uint32_t);
   size_t data_size = FIELD_OFFSET(TraceDetailedFunctionCall, argument_data) +
@@ -219,13 +271,7 @@ void FunctionCallLogger::EmitDetailedFunctionCall(TraceFileSegment* segment,
   data->stack_trace_id = stack_trace_id;
   data->argument_data_size = args_size;
 
-  if (serialize_timestamps_) {
-    base::AutoLock lock(lock_);
-    data->timestamp = call_counter_;
-    ++call_counter_;
-  } else {
-    data->timestamp = ::trace::common::GetTsc();
-  }
+  data->timestamp = GetCallTimestamp();
 
   if (args_size == 0)
     return;
@@ -188,7 +188,8 @@ TEST(FunctionCallLoggerTest, TraceStackTrace) {
   fcl.set_stack_trace_tracking(kTrackingEmit);
   uint32_t stack_trace_id = fcl.GetStackTraceId(&fcl.test_segment_);
   EXPECT_NE(0u, stack_trace_id);
-  EXPECT_THAT(fcl.emitted_stack_ids_, testing::ElementsAre(stack_trace_id));
+  EXPECT_EQ(1u, fcl.emitted_stack_ids_.size());
+  EXPECT_TRUE(fcl.emitted_stack_ids_.Contains(stack_trace_id));
   EXPECT_EQ(1u, fcl.allocation_infos.size());
   const auto& info = fcl.allocation_infos[0];
   EXPECT_EQ(TraceStackTrace::kTypeId, info.record_type);
@@ -316,5 +317,35 @@ TEST(FunctionCallLoggerTest, TraceDetailedFunctionCallSerializeTimestamps) {
   }
 }
 
+TEST(FunctionCallLoggerTest, TraceCompactDetailedFunctionCall) {
+  TestFunctionCallLogger fcl;
+  fcl.set_stack_trace_tracking(kTrackingNone);
+  fcl.set_compact_records(true);
+
+  TestEmitDetailedFunctionCall(&fcl);
+  // 1 name, 1 call.
+  ASSERT_EQ(2u, fcl.allocation_infos.size());
+
+  const auto& info = fcl.allocation_infos[1];
+  EXPECT_EQ(TraceCompactDetailedFunctionCall::kTypeId, info.record_type);
+  ASSERT_NE(nullptr, info.record);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(info.record);
+  const uint8_t* end = data + info.record_size;
+
+  // The call is stamped with the time of its record, and encodes the ID of
+  // the function and the size of its sole argument.
+  const uint64_t kExpectedValues[] = { 0, 0, 0, 1, sizeof(void*) };
+  for (size_t i = 0; i < arraysize(kExpectedValues); ++i) {
+    uint64_t value = 0;
+    ASSERT_TRUE(DecodeVarint(&data, end, &value));
+    EXPECT_EQ(kExpectedValues[i], value);
+  }
+
+  // The argument data follows, to the end of the record.
+  ASSERT_EQ(sizeof(void*), static_cast<size_t>(end - data));
+  void* fcl_ptr = &fcl;
+  EXPECT_EQ(0, ::memcmp(&fcl_ptr, data, sizeof(fcl_ptr)));
+}
+
 }  // namespace memprof
 }  // namespace agent
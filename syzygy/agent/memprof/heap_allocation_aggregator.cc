@@ -0,0 +1,184 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/memprof/heap_allocation_aggregator.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace agent {
+namespace memprof {
+
+HeapAllocationAggregator::HeapAllocationAggregator(
+    trace::client::RpcSession* session)
+    : session_(session),
+      snapshot_interval_(base::TimeDelta::FromSeconds(1)),
+      num_dirty_stats_(0),
+      next_snapshot_id_(0),
+      last_snapshot_time_(base::TimeTicks::Now()) {
+  DCHECK_NE(static_cast<trace::client::RpcSession*>(nullptr), session);
+}
+
+void HeapAllocationAggregator::OnAllocation(HANDLE heap,
+                                            const void* address,
+                                            size_t size,
+                                            uint32_t stack_trace_id) {
+  DCHECK_NE(static_cast<const void*>(nullptr), address);
+
+  StatsKey key(stack_trace_id, GetSizeClass(size));
+
+  base::AutoLock lock(lock_);
+
+  // An allocation at the address of one that wasn't seen to be freed means
+  // that the free went unnoticed.
+  auto it = allocations_.find(address);
+  if (it != allocations_.end()) {
+    FreeAllocationUnlocked(it->second);
+    allocations_.erase(it);
+  }
+
+  Allocation& allocation = allocations_[address];
+  allocation.heap = heap;
+  allocation.size = static_cast<uint32_t>(size);
+  allocation.key = key;
+
+  auto result = stats_.insert(std::make_pair(key, Stats()));
+  Stats& stats = result.first->second;
+  if (result.second) {
+    ::memset(&stats, 0, sizeof(stats));
+    stats.stats.stack_trace_id = key.first;
+    stats.stats.size_class = key.second;
+  }
+  ++stats.stats.live_count;
+  stats.stats.live_bytes += allocation.size;
+  ++stats.stats.alloc_count;
+  stats.stats.alloc_bytes += allocation.size;
+  if (!stats.dirty) {
+    stats.dirty = true;
+    ++num_dirty_stats_;
+  }
+}
+
+void HeapAllocationAggregator::OnFree(HANDLE heap, const void* address) {
+  if (address == nullptr)
+    return;
+
+  base::AutoLock lock(lock_);
+  auto it = allocations_.find(address);
+  if (it == allocations_.end() || it->second.heap != heap)
+    return;
+  FreeAllocationUnlocked(it->second);
+  allocations_.erase(it);
+}
+
+void HeapAllocationAggregator::OnHeapDestroyed(HANDLE heap) {
+  base::AutoLock lock(lock_);
+  auto it = allocations_.begin();
+  while (it != allocations_.end()) {
+    if (it->second.heap != heap) {
+      ++it;
+      continue;
+    }
+    FreeAllocationUnlocked(it->second);
+    it = allocations_.erase(it);
+  }
+}
+
+bool HeapAllocationAggregator::WriteSnapshotIfDue(
+    TraceFileSegment* segment) {
+  DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+
+  base::AutoLock lock(lock_);
+  if (base::TimeTicks::Now() - last_snapshot_time_ < snapshot_interval_)
+    return true;
+  return WriteSnapshotUnlocked(segment);
+}
+
+bool HeapAllocationAggregator::WriteSnapshot(TraceFileSegment* segment) {
+  DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+
+  base::AutoLock lock(lock_);
+  return WriteSnapshotUnlocked(segment);
+}
+
+// static
+uint32_t HeapAllocationAggregator::GetSizeClass(size_t size) {
+  uint32_t size_class = 0;
+  for (; size != 0; size >>= 1)
+    ++size_class;
+  return size_class;
+}
+
+bool HeapAllocationAggregator::WriteSnapshotUnlocked(
+    TraceFileSegment* segment) {
+  DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+  lock_.AssertAcquired();
+
+  last_snapshot_time_ = base::TimeTicks::Now();
+  if (num_dirty_stats_ == 0)
+    return true;
+  uint32_t snapshot_id = next_snapshot_id_++;
+
+  // Split the snapshot into records of at most kMaxStatsPerRecord.
+  auto it = stats_.begin();
+  while (num_dirty_stats_ > 0) {
+    size_t num_stats = std::min(num_dirty_stats_, kMaxStatsPerRecord);
+    size_t data_size = FIELD_OFFSET(TraceHeapAllocationSnapshot, stats) +
+        num_stats * sizeof(TraceHeapAllocationStats);
+    if (!segment->CanAllocate(data_size) &&
+        !session_->ExchangeBuffer(segment)) {
+      return false;
+    }
+    DCHECK(segment->CanAllocate(data_size));
+
+    TraceHeapAllocationSnapshot* data =
+        segment->AllocateTraceRecord<TraceHeapAllocationSnapshot>(data_size);
+    DCHECK_NE(static_cast<TraceHeapAllocationSnapshot*>(nullptr), data);
+    data->snapshot_id = snapshot_id;
+    data->num_stats = num_stats;
+
+    for (size_t i = 0; i < num_stats; ++it) {
+      DCHECK(it != stats_.end());
+      if (!it->second.dirty)
+        continue;
+      data->stats[i++] = it->second.stats;
+      it->second.dirty = false;
+    }
+    num_dirty_stats_ -= num_stats;
+  }
+
+  return true;
+}
+
+void HeapAllocationAggregator::FreeAllocationUnlocked(
+    const Allocation& allocation) {
+  lock_.AssertAcquired();
+
+  auto it = stats_.find(allocation.key);
+  DCHECK(it != stats_.end());
+  Stats& stats = it->second;
+  DCHECK_LT(0u, stats.stats.live_count);
+  DCHECK_LE(allocation.size, stats.stats.live_bytes);
+  --stats.stats.live_count;
+  stats.stats.live_bytes -= allocation.size;
+  ++stats.stats.free_count;
+  if (!stats.dirty) {
+    stats.dirty = true;
+    ++num_dirty_stats_;
+  }
+}
+
+}  // namespace memprof
+}  // namespace agent
@@ -0,0 +1,149 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a HeapAllocationAggregator class. This aggregates heap calls
+// in-process by call site and size class, and logs the resulting statistics
+// as periodic TraceHeapAllocationSnapshot records via the call-trace service.
+// This is a far more compact alternative to logging every heap call, for
+// investigations that only need heap growth by call site.
+
+#ifndef SYZYGY_AGENT_MEMPROF_HEAP_ALLOCATION_AGGREGATOR_H_
+#define SYZYGY_AGENT_MEMPROF_HEAP_ALLOCATION_AGGREGATOR_H_
+
+#include <windows.h>
+
+#include <map>
+#include <utility>
+
+#include "base/containers/hash_tables.h"
+#include "base/synchronization/lock.h"
+#include "base/time/time.h"
+#include "syzygy/trace/client/rpc_session.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+
+namespace agent {
+namespace memprof {
+
+class HeapAllocationAggregator {
+ public:
+  typedef trace::client::TraceFileSegment TraceFileSegment;
+
+  // The maximum number of statistics written per record.
+  static const size_t kMaxStatsPerRecord = 256;
+
+  // Constructor.
+  // @param session The call-trace session to log to.
+  explicit HeapAllocationAggregator(trace::client::RpcSession* session);
+
+  // Records an allocation.
+  // @param heap The heap the allocation was made from.
+  // @param address The address of the allocation.
+  // @param size The size of the allocation.
+  // @param stack_trace_id The ID of the stack trace of the allocation.
+  void OnAllocation(HANDLE heap,
+                    const void* address,
+                    size_t size,
+                    uint32_t stack_trace_id);
+
+  // Records a free. Frees of unknown allocations are ignored.
+  // @param heap The heap the allocation was made from.
+  // @param address The address of the allocation.
+  void OnFree(HANDLE heap, const void* address);
+
+  // Records the destruction of a heap, which frees all of its allocations.
+  // @param heap The heap that was destroyed.
+  void OnHeapDestroyed(HANDLE heap);
+
+  // Writes a snapshot if at least the snapshot interval elapsed since the
+  // last one.
+  // @param segment The segment to write to.
+  // @returns true on success, false if a record couldn't be allocated.
+  bool WriteSnapshotIfDue(TraceFileSegment* segment);
+
+  // Writes a snapshot of the statistics that changed since the last one.
+  // @param segment The segment to write to.
+  // @returns true on success, false if a record couldn't be allocated.
+  bool WriteSnapshot(TraceFileSegment* segment);
+
+  // @returns the size class of an allocation of @p size bytes.
+  static uint32_t GetSizeClass(size_t size);
+
+  // @name Accessors and mutators.
+  // @{
+  base::TimeDelta snapshot_interval() const { return snapshot_interval_; }
+  void set_snapshot_interval(base::TimeDelta snapshot_interval) {
+    snapshot_interval_ = snapshot_interval;
+  }
+  // @}
+
+ protected:
+  // Identifies the statistics of a call site and size class.
+  typedef std::pair<uint32_t, uint32_t> StatsKey;
+
+  // The statistics of a call site and size class.
+  struct Stats {
+    TraceHeapAllocationStats stats;
+    // True if the statistics changed since the last snapshot.
+    bool dirty;
+  };
+
+  // A live allocation.
+  struct Allocation {
+    HANDLE heap;
+    uint32_t size;
+    StatsKey key;
+  };
+
+  // Writes a snapshot of the statistics that changed since the last one.
+  // @param segment The segment to write to.
+  // @returns true on success, false if a record couldn't be allocated.
+  bool WriteSnapshotUnlocked(TraceFileSegment* segment);
+
+  // Updates the statistics of @p allocation, which was freed.
+  void FreeAllocationUnlocked(const Allocation& allocation);
+
+  // The RPC session the snapshots are written to.
+  trace::client::RpcSession* session_;
+
+  // The interval between snapshots.
+  base::TimeDelta snapshot_interval_;
+
+  // A lock that is used for synchronizing access to internals.
+  base::Lock lock_;
+
+  // The statistics by call site and size class.
+  typedef std::map<StatsKey, Stats> StatsMap;
+  StatsMap stats_;  // Under lock_.
+
+  // The live allocations by address.
+  typedef base::hash_map<const void*, Allocation> AllocationMap;
+  AllocationMap allocations_;  // Under lock_.
+
+  // The number of statistics that changed since the last snapshot.
+  size_t num_dirty_stats_;  // Under lock_.
+
+  // The ID of the next snapshot.
+  uint32_t next_snapshot_id_;  // Under lock_.
+
+  // The time of the last snapshot.
+  base::TimeTicks last_snapshot_time_;  // Under lock_.
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HeapAllocationAggregator);
+};
+
+}  // namespace memprof
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_MEMPROF_HEAP_ALLOCATION_AGGREGATOR_H_
@@ -0,0 +1,221 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/memprof/heap_allocation_aggregator.h"
+
+#include <list>
+#include <vector>
+
+#include "base/bind.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace memprof {
+
+namespace {
+
+using trace::client::TraceFileSegment;
+
+// An RPC session that hands out buffers of its own, and keeps them around so
+// that the records written to them can be inspected.
+class TestRpcSession : public trace::client::RpcSession {
+ public:
+  bool AllocateBuffer(TraceFileSegment* segment) override {
+    DCHECK_NE(static_cast<TraceFileSegment*>(nullptr), segment);
+    buffers_.push_back(std::vector<uint8_t>(kBufferSize));
+    segment->base_ptr = buffers_.back().data();
+    segment->end_ptr = segment->base_ptr + kBufferSize;
+    segment->header = reinterpret_cast<TraceFileSegmentHeader*>(
+        segment->base_ptr);
+    segment->write_ptr = reinterpret_cast<uint8_t*>(segment->header + 1);
+    segment->header->thread_id = ::GetCurrentThreadId();
+    segment->header->segment_length = 0;
+    return true;
+  }
+
+  bool ExchangeBuffer(TraceFileSegment* segment) override {
+    return AllocateBuffer(segment);
+  }
+
+  // Big enough for a few records, so that large snapshots span buffers.
+  static const size_t kBufferSize = 16 * 1024;
+
+ private:
+  std::list<std::vector<uint8_t>> buffers_;
+};
+
+class HeapAllocationAggregatorTest : public testing::Test {
+ public:
+  HeapAllocationAggregatorTest()
+      : aggregator_(&session_),
+        heap_(reinterpret_cast<HANDLE>(0x10000)) {
+  }
+
+  void SetUp() override {
+    segment_.allocate_callback =
+        base::Bind(&HeapAllocationAggregatorTest::AllocateCallback,
+                   base::Unretained(this));
+    ASSERT_TRUE(session_.AllocateBuffer(&segment_));
+  }
+
+  // Records the snapshot records written to the segment.
+  void AllocateCallback(int record_type, size_t record_size, void* record) {
+    ASSERT_EQ(TraceHeapAllocationSnapshot::kTypeId, record_type);
+    snapshots_.push_back(
+        reinterpret_cast<const TraceHeapAllocationSnapshot*>(record));
+  }
+
+  // @returns the statistics of @p stack_trace_id and @p size_class in the
+  //     last snapshot, or nullptr if there are none.
+  const TraceHeapAllocationStats* FindStats(uint32_t stack_trace_id,
+                                            uint32_t size_class) {
+    if (snapshots_.empty())
+      return nullptr;
+    uint32_t snapshot_id = snapshots_.back()->snapshot_id;
+    for (const TraceHeapAllocationSnapshot* snapshot : snapshots_) {
+      if (snapshot->snapshot_id != snapshot_id)
+        continue;
+      for (size_t i = 0; i < snapshot->num_stats; ++i) {
+        const TraceHeapAllocationStats& stats = snapshot->stats[i];
+        if (stats.stack_trace_id == stack_trace_id &&
+            stats.size_class == size_class) {
+          return &stats;
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  const void* Address(size_t i) {
+    return reinterpret_cast<const void*>(0x20000 + i * 0x10);
+  }
+
+  TestRpcSession session_;
+  TraceFileSegment segment_;
+  HeapAllocationAggregator aggregator_;
+  HANDLE heap_;
+  std::vector<const TraceHeapAllocationSnapshot*> snapshots_;
+};
+
+}  // namespace
+
+TEST_F(HeapAllocationAggregatorTest, GetSizeClass) {
+  EXPECT_EQ(0u, HeapAllocationAggregator::GetSizeClass(0));
+  EXPECT_EQ(1u, HeapAllocationAggregator::GetSizeClass(1));
+  EXPECT_EQ(2u, HeapAllocationAggregator::GetSizeClass(2));
+  EXPECT_EQ(2u, HeapAllocationAggregator::GetSizeClass(3));
+  EXPECT_EQ(3u, HeapAllocationAggregator::GetSizeClass(4));
+  EXPECT_EQ(11u, HeapAllocationAggregator::GetSizeClass(1024));
+  EXPECT_EQ(11u, HeapAllocationAggregator::GetSizeClass(2047));
+}
+
+TEST_F(HeapAllocationAggregatorTest, AggregatesByStackAndSizeClass) {
+  aggregator_.OnAllocation(heap_, Address(0), 100, 1);
+  aggregator_.OnAllocation(heap_, Address(1), 120, 1);
+  aggregator_.OnAllocation(heap_, Address(2), 1000, 1);
+  aggregator_.OnAllocation(heap_, Address(3), 100, 2);
+  aggregator_.OnFree(heap_, Address(1));
+
+  // Frees of unknown allocations, or from the wrong heap, are ignored.
+  aggregator_.OnFree(heap_, Address(4));
+  aggregator_.OnFree(reinterpret_cast<HANDLE>(0x30000), Address(0));
+
+  ASSERT_TRUE(aggregator_.WriteSnapshot(&segment_));
+  ASSERT_EQ(1u, snapshots_.size());
+  EXPECT_EQ(0u, snapshots_[0]->snapshot_id);
+  EXPECT_EQ(3u, snapshots_[0]->num_stats);
+
+  const TraceHeapAllocationStats* stats = FindStats(1, 7);
+  ASSERT_NE(static_cast<const TraceHeapAllocationStats*>(nullptr), stats);
+  EXPECT_EQ(1u, stats->live_count);
+  EXPECT_EQ(100u, stats->live_bytes);
+  EXPECT_EQ(2u, stats->alloc_count);
+  EXPECT_EQ(1u, stats->free_count);
+  EXPECT_EQ(220u, stats->alloc_bytes);
+
+  stats = FindStats(1, 10);
+  ASSERT_NE(static_cast<const TraceHeapAllocationStats*>(nullptr), stats);
+  EXPECT_EQ(1u, stats->live_count);
+  EXPECT_EQ(1000u, stats->live_bytes);
+
+  stats = FindStats(2, 7);
+  ASSERT_NE(static_cast<const TraceHeapAllocationStats*>(nullptr), stats);
+  EXPECT_EQ(1u, stats->live_count);
+  EXPECT_EQ(100u, stats->live_bytes);
+}
+
+TEST_F(HeapAllocationAggregatorTest, SnapshotsOnlyChangedStats) {
+  aggregator_.OnAllocation(heap_, Address(0), 100, 1);
+  aggregator_.OnAllocation(heap_, Address(1), 100, 2);
+  ASSERT_TRUE(aggregator_.WriteSnapshot(&segment_));
+  ASSERT_EQ(1u, snapshots_.size());
+  EXPECT_EQ(2u, snapshots_[0]->num_stats);
+
+  // Nothing changed, so nothing is written.
+  ASSERT_TRUE(aggregator_.WriteSnapshot(&segment_));
+  EXPECT_EQ(1u, snapshots_.size());
+
+  aggregator_.OnFree(heap_, Address(1));
+  ASSERT_TRUE(aggregator_.WriteSnapshot(&segment_));
+  ASSERT_EQ(2u, snapshots_.size());
+  EXPECT_EQ(1u, snapshots_[1]->snapshot_id);
+  ASSERT_EQ(1u, snapshots_[1]->num_stats);
+  EXPECT_EQ(2u, snapshots_[1]->stats[0].stack_trace_id);
+  EXPECT_EQ(0u, snapshots_[1]->stats[0].live_count);
+  EXPECT_EQ(1u, snapshots_[1]->stats[0].free_count);
+}
+
+TEST_F(HeapAllocationAggregatorTest, HeapDestroyFreesAllocations) {
+  HANDLE other_heap = reinterpret_cast<HANDLE>(0x30000);
+  aggregator_.OnAllocation(heap_, Address(0), 100, 1);
+  aggregator_.OnAllocation(heap_, Address(1), 100, 1);
+  aggregator_.OnAllocation(other_heap, Address(2), 100, 1);
+  aggregator_.OnHeapDestroyed(heap_);
+
+  ASSERT_TRUE(aggregator_.WriteSnapshot(&segment_));
+  const TraceHeapAllocationStats* stats = FindStats(1, 7);
+  ASSERT_NE(static_cast<const TraceHeapAllocationStats*>(nullptr), stats);
+  EXPECT_EQ(1u, stats->live_count);
+  EXPECT_EQ(3u, stats->alloc_count);
+  EXPECT_EQ(2u, stats->free_count);
+}
+
+TEST_F(HeapAllocationAggregatorTest, LargeSnapshotsSpanRecords) {
+  const size_t kNumStats = 3 * HeapAllocationAggregator::kMaxStatsPerRecord;
+  for (size_t i = 0; i < kNumStats; ++i)
+    aggregator_.OnAllocation(heap_, Address(i), 16, i);
+
+  ASSERT_TRUE(aggregator_.WriteSnapshot(&segment_));
+  ASSERT_EQ(3u, snapshots_.size());
+  size_t num_stats = 0;
+  for (const TraceHeapAllocationSnapshot* snapshot : snapshots_) {
+    EXPECT_EQ(0u, snapshot->snapshot_id);
+    num_stats += snapshot->num_stats;
+  }
+  EXPECT_EQ(kNumStats, num_stats);
+}
+
+TEST_F(HeapAllocationAggregatorTest, WriteSnapshotIfDue) {
+  aggregator_.set_snapshot_interval(base::TimeDelta::FromDays(1));
+  aggregator_.OnAllocation(heap_, Address(0), 100, 1);
+  ASSERT_TRUE(aggregator_.WriteSnapshotIfDue(&segment_));
+  EXPECT_TRUE(snapshots_.empty());
+
+  aggregator_.set_snapshot_interval(base::TimeDelta());
+  ASSERT_TRUE(aggregator_.WriteSnapshotIfDue(&segment_));
+  EXPECT_EQ(1u, snapshots_.size());
+}
+
+}  // namespace memprof
+}  // namespace agent
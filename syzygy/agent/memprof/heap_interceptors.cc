@@ -23,15 +23,17 @@
 #include "syzygy/agent/memprof/memprof.h"
 
 // A wrapper to EMIT_DETAILED_FUNCTION_CALL that provides the MemoryProfiler
-// FunctionCallLogger instance.
+// FunctionCallLogger instance. Nothing is emitted when heap calls are
+// aggregated.
 #define EMIT_DETAILED_HEAP_FUNCTION_CALL(...)  \
     DCHECK_NE(static_cast<agent::memprof::MemoryProfiler*>(nullptr),  \
               agent::memprof::memory_profiler.get());  \
-    EMIT_DETAILED_FUNCTION_CALL(  \
-        &agent::memprof::memory_profiler->function_call_logger(),  \
-        agent::memprof::memory_profiler->GetOrAllocateThreadState()->  \
-            segment(),  \
-        __VA_ARGS__);
+    if (!agent::memprof::memory_profiler->aggregate_heap_calls())  \
+      EMIT_DETAILED_FUNCTION_CALL(  \
+          &agent::memprof::memory_profiler->function_call_logger(),  \
+          agent::memprof::memory_profiler->GetOrAllocateThreadState()->  \
+              segment(),  \
+          __VA_ARGS__);
 
 // A conditional scoped lock, based on timestamp serialization. Used to
 // completely serialize heap access when enabled.
@@ -78,6 +80,8 @@ BOOL WINAPI asan_HeapDestroy(HANDLE heap) {
   // is enabled.
   ConditionalScopedLock conditional_scoped_lock;
   BOOL ret = ::HeapDestroy(heap);
+  if (ret && agent::memprof::memory_profiler->aggregate_heap_calls())
+    agent::memprof::memory_profiler->AggregateHeapDestroy(heap);
   EMIT_DETAILED_HEAP_FUNCTION_CALL(heap, ret);
   return ret;
 }
@@ -89,6 +93,10 @@ LPVOID WINAPI asan_HeapAlloc(HANDLE heap,
   // is enabled.
   ConditionalScopedLock conditional_scoped_lock;
   LPVOID ret = ::HeapAlloc(heap, flags, bytes);
+  if (ret != nullptr &&
+      agent::memprof::memory_profiler->aggregate_heap_calls()) {
+    agent::memprof::memory_profiler->AggregateHeapAllocation(heap, ret, bytes);
+  }
   EMIT_DETAILED_HEAP_FUNCTION_CALL(heap, flags, bytes, ret);
   return ret;
 }
@@ -101,6 +109,12 @@ LPVOID WINAPI asan_HeapReAlloc(HANDLE heap,
   // is enabled.
   ConditionalScopedLock conditional_scoped_lock;
   LPVOID ret = ::HeapReAlloc(heap, flags, mem, bytes);
+  // A reallocation that fails leaves the original allocation in place.
+  if (ret != nullptr &&
+      agent::memprof::memory_profiler->aggregate_heap_calls()) {
+    agent::memprof::memory_profiler->AggregateHeapFree(heap, mem);
+    agent::memprof::memory_profiler->AggregateHeapAllocation(heap, ret, bytes);
+  }
   EMIT_DETAILED_HEAP_FUNCTION_CALL(heap, flags, mem, bytes, ret);
   return ret;
 }
@@ -120,6 +134,8 @@ BOOL WINAPI asan_HeapFree(HANDLE heap,
   // is enabled.
   ConditionalScopedLock conditional_scoped_lock;
   BOOL ret = ::HeapFree(heap, flags, mem);
+  if (ret && agent::memprof::memory_profiler->aggregate_heap_calls())
+    agent::memprof::memory_profiler->AggregateHeapFree(heap, mem);
   EMIT_DETAILED_HEAP_FUNCTION_CALL(heap, flags, mem, ret, hash);
   return ret;
 }
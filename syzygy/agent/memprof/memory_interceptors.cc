@@ -36,6 +36,16 @@ extern "C" {
     __asm ret  \
   }
 
+// Range probes are called with EDX and then the length of the range pushed on
+// the stack, and the start of the range in EDX.
+#define DEFINE_NULL_RANGE_PROBE(name)  \
+  void __declspec(naked) name() {  \
+    /* Restore the value of EDX. */  \
+    __asm mov edx, DWORD PTR[esp + 8]  \
+    /* Return and pop the length and saved EDX value off the stack. */  \
+    __asm ret 8  \
+  }
+
 // Define all of the null memory probes.
 DEFINE_NULL_MEMORY_PROBE(asan_check_1_byte_read_access);
 DEFINE_NULL_MEMORY_PROBE(asan_check_2_byte_read_access);
@@ -89,7 +99,10 @@ DEFINE_NULL_SPECIAL_PROBE(asan_check_4_byte_movs_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_1_byte_stos_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_2_byte_stos_access);
 DEFINE_NULL_SPECIAL_PROBE(asan_check_4_byte_stos_access);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_read_access);
+DEFINE_NULL_RANGE_PROBE(asan_check_range_write_access);
 #undef DEFINE_NULL_MEMORY_PROBE
 #undef DEFINE_NULL_STRING_PROBE
+#undef DEFINE_NULL_RANGE_PROBE
 
 }  // extern "C"
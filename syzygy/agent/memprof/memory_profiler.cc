@@ -26,6 +26,15 @@ MemoryProfiler::MemoryProfiler()
   SetDefaultParameters(&parameters_);
 }
 
+MemoryProfiler::~MemoryProfiler() {
+  if (!aggregate_heap_calls() || !session_.IsTracing())
+    return;
+
+  ThreadState* state = GetOrAllocateThreadState();
+  if (heap_allocation_aggregator_->WriteSnapshot(state->segment()))
+    state->FlushSegment();
+}
+
 bool MemoryProfiler::Init() {
   // We don't care if parameter parsing fails at runtime; such parameters will
   // simply be ignored.
@@ -36,6 +45,8 @@ bool MemoryProfiler::Init() {
           &session_, state->segment())) {
     return false;
   }
+  function_call_logger_.set_compact_records(
+      session_.IsEnabled(TRACE_FLAG_COMPACT_RECORDS));
 
   // Get a list of all existing heaps.
   std::vector<HANDLE> heaps(16, 0);
@@ -67,10 +78,11 @@ bool MemoryProfiler::Init() {
     proc_heap->process_heap = reinterpret_cast<uint32_t>(heap);
   }
 
-  // Setup the DLL watcher. This will be notified of module load and unload
-  // events as they occur.
-  dll_watcher_.Init(base::Bind(&MemoryProfiler::OnDllEvent,
-                               base::Unretained(this)));
+  // Setup the DLL watcher. This queues module load and unload events as they
+  // occur, and they're logged in batches from the next heap call rather than
+  // under the loader lock.
+  dll_watcher_.InitQueued(base::Bind(&MemoryProfiler::OnDllEvent,
+                                     base::Unretained(this)));
 
   // Log all modules that are already loaded when we are. Further modules
   // will be logged as they load and unload via the DllNotification
@@ -85,6 +97,11 @@ MemoryProfiler::ThreadState* MemoryProfiler::GetOrAllocateThreadState() {
   if (!data->segment()->write_ptr && session_.IsTracing())
     session_.AllocateBuffer(data->segment());
 
+  // Log the modules that loaded since the last call, ahead of any event that
+  // may refer to them.
+  if (dll_watcher_.HasPendingEvents())
+    dll_watcher_.ProcessPendingEvents();
+
   return data;
 }
 
@@ -97,6 +114,44 @@ void MemoryProfiler::PropagateParameters() {
       parameters_.stack_trace_tracking);
   function_call_logger_.set_serialize_timestamps(
       parameters_.serialize_timestamps);
+
+  if (!parameters_.aggregate_heap_calls) {
+    heap_allocation_aggregator_.reset();
+    return;
+  }
+
+  // The snapshots refer to the stack traces of the call sites, which must be
+  // emitted.
+  function_call_logger_.set_stack_trace_tracking(kTrackingEmit);
+  heap_allocation_aggregator_.reset(new HeapAllocationAggregator(&session_));
+  heap_allocation_aggregator_->set_snapshot_interval(
+      base::TimeDelta::FromMilliseconds(parameters_.snapshot_interval_ms));
+}
+
+void MemoryProfiler::AggregateHeapAllocation(HANDLE heap,
+                                             const void* address,
+                                             size_t size) {
+  DCHECK(aggregate_heap_calls());
+  ThreadState* state = GetOrAllocateThreadState();
+  uint32_t stack_trace_id =
+      function_call_logger_.GetStackTraceId(state->segment());
+  heap_allocation_aggregator_->OnAllocation(heap, address, size,
+                                            stack_trace_id);
+  heap_allocation_aggregator_->WriteSnapshotIfDue(state->segment());
+}
+
+void MemoryProfiler::AggregateHeapFree(HANDLE heap, const void* address) {
+  DCHECK(aggregate_heap_calls());
+  heap_allocation_aggregator_->OnFree(heap, address);
+  heap_allocation_aggregator_->WriteSnapshotIfDue(
+      GetOrAllocateThreadState()->segment());
+}
+
+void MemoryProfiler::AggregateHeapDestroy(HANDLE heap) {
+  DCHECK(aggregate_heap_calls());
+  heap_allocation_aggregator_->OnHeapDestroyed(heap);
+  heap_allocation_aggregator_->WriteSnapshotIfDue(
+      GetOrAllocateThreadState()->segment());
 }
 
 MemoryProfiler::ThreadState* MemoryProfiler::GetOrAllocateThreadStateImpl() {
@@ -20,11 +20,14 @@
 #ifndef SYZYGY_AGENT_MEMPROF_MEMORY_PROFILER_H_
 #define SYZYGY_AGENT_MEMPROF_MEMORY_PROFILER_H_
 
+#include <memory>
+
 #include "base/threading/thread_local.h"
 #include "syzygy/agent/common/agent.h"
 #include "syzygy/agent/common/dll_notifications.h"
 #include "syzygy/agent/common/thread_state.h"
 #include "syzygy/agent/memprof/function_call_logger.h"
+#include "syzygy/agent/memprof/heap_allocation_aggregator.h"
 #include "syzygy/agent/memprof/parameters.h"
 #include "syzygy/common/logging.h"
 #include "syzygy/trace/client/rpc_session.h"
@@ -36,6 +39,9 @@ class MemoryProfiler {
  public:
   MemoryProfiler();
 
+  // Writes a final heap allocation snapshot when aggregating heap calls.
+  ~MemoryProfiler();
+
   // Initializes this memory profiler.
   // @returns true for success, false otherwise.
   bool Init();
@@ -60,6 +66,29 @@ class MemoryProfiler {
   // @returns the current parameters.
   const Parameters& parameters() const { return parameters_; }
 
+  // @returns true if heap calls are aggregated in-process rather than
+  //     logged as detailed function calls.
+  bool aggregate_heap_calls() const {
+    return heap_allocation_aggregator_.get() != nullptr;
+  }
+
+  // @name Heap call aggregation. These may only be called when aggregating
+  //     heap calls, and write a snapshot when one is due.
+  // @{
+  // Records an allocation from the current stack.
+  // @param heap The heap the allocation was made from.
+  // @param address The address of the allocation.
+  // @param size The size of the allocation.
+  void AggregateHeapAllocation(HANDLE heap, const void* address, size_t size);
+  // Records a free.
+  // @param heap The heap the allocation was made from.
+  // @param address The address of the allocation.
+  void AggregateHeapFree(HANDLE heap, const void* address);
+  // Records the destruction of a heap.
+  // @param heap The heap that was destroyed.
+  void AggregateHeapDestroy(HANDLE heap);
+  // @}
+
  protected:
   friend class ThreadState;
 
@@ -100,7 +129,11 @@ class MemoryProfiler {
   // The parameters that we use. These are parsed from the environment.
   Parameters parameters_;
 
-  // To keep track of modules added after initialization.
+  // The aggregator of heap calls, if they are aggregated.
+  std::unique_ptr<HeapAllocationAggregator> heap_allocation_aggregator_;
+
+  // To keep track of modules added after initialization. Its events are
+  // queued, and processed by GetOrAllocateThreadState.
   agent::common::DllNotificationWatcher dll_watcher_;
 
   // Contains the set of modules we've seen and logged.
@@ -37,10 +37,14 @@
       'type': 'static_library',
       'sources': [
         'asan_compatibility.cc',
+        'concurrent_id_set.cc',
+        'concurrent_id_set.h',
         'crt_interceptors.cc',
         'heap_interceptors.cc',
         'function_call_logger.cc',
         'function_call_logger.h',
+        'heap_allocation_aggregator.cc',
+        'heap_allocation_aggregator.h',
         'memory_interceptors.cc',
         'memory_profiler.cc',
         'memory_profiler.h',
@@ -118,7 +122,9 @@
       'target_name': 'memprof_unittests',
       'type': 'executable',
       'sources': [
+        'concurrent_id_set_unittest.cc',
         'function_call_logger_unittest.cc',
+        'heap_allocation_aggregator_unittest.cc',
         'memprof_unittest.cc',
         'parameters_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
@@ -237,5 +237,42 @@ TEST_F(MemoryProfilerTest, ExpectedRecordsSeenTestWithStackTraces) {
   ASSERT_NO_FATAL_FAILURE(ExpectedRecordsSeenTest(true));
 }
 
+TEST_F(MemoryProfilerTest, AggregatesHeapCalls) {
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_NE(static_cast<base::Environment*>(nullptr), env.get());
+  env->SetVar(kParametersEnvVar, "--aggregate-heap-calls");
+
+  ASSERT_NO_FATAL_FAILURE(StartService());
+  ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+  DWORD process_id = ::GetCurrentProcessId();
+
+  HANDLE heap = (*heap_create_)(0, 0, 0);
+  ASSERT_TRUE(heap != nullptr);
+  void* alloc = (*heap_alloc_)(heap, 0, 1024);
+  ASSERT_TRUE(alloc != nullptr);
+  (*heap_free_)(heap, 0, alloc);
+  (*heap_destroy_)(heap);
+
+  ASSERT_NO_FATAL_FAILURE(UnloadDll());
+  ASSERT_NO_FATAL_FAILURE(StopService());
+
+  env->UnSetVar(kParametersEnvVar);
+
+  // The heap calls aren't logged, but the stack trace of the allocation is,
+  // followed by at least the final snapshot.
+  EXPECT_CALL(handler_, OnProcessStarted(_, process_id, _));
+  EXPECT_CALL(handler_, OnProcessAttach(_, process_id, _, _))
+      .Times(testing::AnyNumber());
+  EXPECT_CALL(handler_, OnProcessHeap(_, process_id, _))
+      .Times(testing::AnyNumber());
+  EXPECT_CALL(handler_, OnStackTrace(_, process_id, _));
+  EXPECT_CALL(handler_, OnHeapAllocationSnapshot(_, process_id, _))
+      .Times(testing::AtLeast(1));
+  EXPECT_CALL(handler_, OnProcessEnded(_, process_id));
+
+  ASSERT_NO_FATAL_FAILURE(ReplayLogs());
+}
+
 }  // namespace memprof
 }  // namespace agent
@@ -17,6 +17,7 @@
 #include "base/command_line.h"
 #include "base/environment.h"
 #include "base/logging.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/utf_string_conversions.h"
 
 namespace agent {
@@ -36,17 +37,23 @@ const char kParametersEnvVar[] = "SYZYGY_MEMPROF_OPTIONS";
 StackTraceTracking kDefaultStackTraceTracking = kTrackingNone;
 bool kDefaultSerializeTimestamps = false;
 bool kDefaultHashContentsAtFree = false;
+bool kDefaultAggregateHeapCalls = false;
+uint32_t kDefaultSnapshotIntervalMs = 1000;
 
 // Parameter names for parsing.
 const char kParamStackTraceTracking[] = "stack-trace-tracking";
 const char kParamSerializeTimestamps[] = "serialize-timestamps";
 const char kParamHashContentsAtFree[] = "hash-contents-at-free";
+const char kParamAggregateHeapCalls[] = "aggregate-heap-calls";
+const char kParamSnapshotIntervalMs[] = "snapshot-interval-ms";
 
 void SetDefaultParameters(Parameters* parameters) {
   DCHECK_NE(static_cast<Parameters*>(nullptr), parameters);
   parameters->stack_trace_tracking = kDefaultStackTraceTracking;
   parameters->serialize_timestamps = false;
   parameters->hash_contents_at_free = false;
+  parameters->aggregate_heap_calls = kDefaultAggregateHeapCalls;
+  parameters->snapshot_interval_ms = kDefaultSnapshotIntervalMs;
 }
 
 bool ParseParameters(const base::StringPiece& param_string,
@@ -86,6 +93,21 @@ bool ParseParameters(const base::StringPiece& param_string,
   if (cmd_line.HasSwitch(kParamHashContentsAtFree))
     parameters->hash_contents_at_free = true;
 
+  if (cmd_line.HasSwitch(kParamAggregateHeapCalls))
+    parameters->aggregate_heap_calls = true;
+
+  value = cmd_line.GetSwitchValueASCII(kParamSnapshotIntervalMs);
+  if (!value.empty()) {
+    unsigned interval = 0;
+    if (!base::StringToUint(value, &interval) || interval == 0) {
+      LOG(ERROR) << "Invalid value for --" << kParamSnapshotIntervalMs
+                 << ": " << value;
+      success = false;
+    } else {
+      parameters->snapshot_interval_ms = interval;
+    }
+  }
+
   return success;
 }
 
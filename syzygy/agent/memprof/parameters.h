@@ -49,6 +49,13 @@ struct Parameters {
   // the hash value stored as an additional parameter to the heap free
   // function.
   bool hash_contents_at_free;
+  // If this is enabled then heap calls are aggregated in-process by call
+  // site and size class, and emitted as periodic snapshots rather than as
+  // DetailedFunctionCall records.
+  bool aggregate_heap_calls;
+  // The interval between heap allocation snapshots, in milliseconds, when
+  // aggregating heap calls.
+  uint32_t snapshot_interval_ms;
 };
 
 // The environment variable that is used for extracting parameters.
@@ -61,11 +68,15 @@ extern const char* kStackTraceTrackingValues[];
 extern StackTraceTracking kDefaultStackTraceTracking;
 extern bool kDefaultSerializeTimestamps;
 extern bool kDefaultHashContentsAtFree;
+extern bool kDefaultAggregateHeapCalls;
+extern uint32_t kDefaultSnapshotIntervalMs;
 
 // Parameter names for parsing.
 extern const char kParamStackTraceTracking[];
 extern const char kParamSerializeTimestamps[];
 extern const char kParamHashContentsAtFree[];
+extern const char kParamAggregateHeapCalls[];
+extern const char kParamSnapshotIntervalMs[];
 
 // Initializes a Parameters struct with default values.
 // @param parameters The Parameters struct to be initialized.
@@ -26,6 +26,8 @@ TEST(ParametersTest, SetDefaults) {
   EXPECT_EQ(kDefaultStackTraceTracking, p.stack_trace_tracking);
   EXPECT_EQ(kDefaultSerializeTimestamps, p.serialize_timestamps);
   EXPECT_EQ(kDefaultHashContentsAtFree, p.hash_contents_at_free);
+  EXPECT_EQ(kDefaultAggregateHeapCalls, p.aggregate_heap_calls);
+  EXPECT_EQ(kDefaultSnapshotIntervalMs, p.snapshot_interval_ms);
 }
 
 TEST(ParametersTest, ParseInvalidStackTraceTracking) {
@@ -35,6 +37,13 @@ TEST(ParametersTest, ParseInvalidStackTraceTracking) {
   EXPECT_FALSE(ParseParameters(str, &p));
 }
 
+TEST(ParametersTest, ParseInvalidSnapshotInterval) {
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_FALSE(ParseParameters("--snapshot-interval-ms=foo", &p));
+  EXPECT_FALSE(ParseParameters("--snapshot-interval-ms=0", &p));
+}
+
 TEST(ParametersTest, ParseMinimalCommandLine) {
   Parameters p = {};
   SetDefaultParameters(&p);
@@ -50,11 +59,15 @@ TEST(ParametersTest, ParseMaximalCommandLine) {
   SetDefaultParameters(&p);
   std::string str("--stack-trace-tracking=emit "
                   "--serialize-timestamps "
-                  "--hash-contents-at-free");
+                  "--hash-contents-at-free "
+                  "--aggregate-heap-calls "
+                  "--snapshot-interval-ms=250");
   EXPECT_TRUE(ParseParameters(str, &p));
   EXPECT_EQ(kTrackingEmit, p.stack_trace_tracking);
   EXPECT_TRUE(p.serialize_timestamps);
   EXPECT_TRUE(p.hash_contents_at_free);
+  EXPECT_TRUE(p.aggregate_heap_calls);
+  EXPECT_EQ(250u, p.snapshot_interval_ms);
 }
 
 TEST(ParametersTest, ParseNoEnvironment) {
@@ -0,0 +1,66 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares structures and parsing routines for Profiler runtime parameters.
+
+#ifndef SYZYGY_AGENT_PROFILER_PARAMETERS_H_
+#define SYZYGY_AGENT_PROFILER_PARAMETERS_H_
+
+#include "base/strings/string_piece.h"
+
+namespace agent {
+namespace profiler {
+
+// A structure housing runtime parameters for the profiler agent.
+struct Parameters {
+  // Every Nth call of a thread is timed, and stands for the calls skipped
+  // since the previous timed call. This is 1 to time every call, or 0 to
+  // only sample by cycles.
+  uint32_t sampling_interval;
+  // If non-zero, the first call of a thread once this many cycles have
+  // elapsed since its previous timed call is also timed.
+  uint64_t sampling_cycles;
+};
+
+// The environment variable that is used for extracting parameters.
+extern const char kParametersEnvVar[];
+
+// Default parameter values.
+extern const uint32_t kDefaultSamplingInterval;
+extern const uint64_t kDefaultSamplingCycles;
+
+// Parameter names for parsing.
+extern const char kParamSamplingInterval[];
+extern const char kParamSamplingCycles[];
+
+// Initializes a Parameters struct with default values.
+// @param parameters The Parameters struct to be initialized.
+void SetDefaultParameters(Parameters* parameters);
+
+// Parses parameters from a string and updates the provided structure.
+// @param param_string the string of parameters to be parsed.
+// @param parameters The Parameters struct to be updated.
+// @returns true on success, false otherwise. Logs verbosely on failure.
+bool ParseParameters(const base::StringPiece& param_string,
+                     Parameters* parameters);
+
+// Parses parameters from the environment and updates the provided structure.
+// @param parameters The Parameters struct to be updated.
+// @returns true on success, false otherwise. Logs verbosely on failure.
+bool ParseParametersFromEnv(Parameters* parameters);
+
+}  // namespace profiler
+}  // namespace agent
+
+#endif  // SYZYGY_AGENT_PROFILER_PARAMETERS_H_
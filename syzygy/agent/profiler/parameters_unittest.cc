@@ -0,0 +1,103 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/agent/profiler/parameters.h"
+
+#include <memory>
+
+#include "base/environment.h"
+#include "gtest/gtest.h"
+
+namespace agent {
+namespace profiler {
+
+TEST(ParametersTest, SetDefaults) {
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_EQ(kDefaultSamplingInterval, p.sampling_interval);
+  EXPECT_EQ(kDefaultSamplingCycles, p.sampling_cycles);
+}
+
+TEST(ParametersTest, ParseInvalidSamplingInterval) {
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_FALSE(ParseParameters("--sampling-interval=foo", &p));
+  EXPECT_EQ(kDefaultSamplingInterval, p.sampling_interval);
+
+  // Calls can't go untimed altogether.
+  EXPECT_FALSE(ParseParameters("--sampling-interval=0", &p));
+}
+
+TEST(ParametersTest, ParseInvalidSamplingCycles) {
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_FALSE(ParseParameters("--sampling-cycles=-1", &p));
+  EXPECT_EQ(kDefaultSamplingCycles, p.sampling_cycles);
+}
+
+TEST(ParametersTest, ParseMinimalCommandLine) {
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_TRUE(ParseParameters("", &p));
+  EXPECT_EQ(kDefaultSamplingInterval, p.sampling_interval);
+  EXPECT_EQ(kDefaultSamplingCycles, p.sampling_cycles);
+}
+
+TEST(ParametersTest, ParseMaximalCommandLine) {
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_TRUE(ParseParameters("--sampling-interval=100 "
+                              "--sampling-cycles=1000000",
+                              &p));
+  EXPECT_EQ(100u, p.sampling_interval);
+  EXPECT_EQ(1000000u, p.sampling_cycles);
+}
+
+TEST(ParametersTest, ParseSamplingByCyclesOnly) {
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_TRUE(ParseParameters("--sampling-interval=0 --sampling-cycles=5000",
+                              &p));
+  EXPECT_EQ(0u, p.sampling_interval);
+  EXPECT_EQ(5000u, p.sampling_cycles);
+}
+
+TEST(ParametersTest, ParseNoEnvironment) {
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_NE(nullptr, env.get());
+  env->UnSetVar(kParametersEnvVar);
+
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_TRUE(ParseParametersFromEnv(&p));
+  EXPECT_EQ(kDefaultSamplingInterval, p.sampling_interval);
+  EXPECT_EQ(kDefaultSamplingCycles, p.sampling_cycles);
+}
+
+TEST(ParametersTest, ParseEnvironment) {
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_NE(nullptr, env.get());
+  env->SetVar(kParametersEnvVar, "--sampling-interval=10");
+
+  Parameters p = {};
+  SetDefaultParameters(&p);
+  EXPECT_TRUE(ParseParametersFromEnv(&p));
+  EXPECT_EQ(10u, p.sampling_interval);
+  EXPECT_EQ(kDefaultSamplingCycles, p.sampling_cycles);
+
+  env->UnSetVar(kParametersEnvVar);
+}
+
+}  // namespace profiler
+}  // namespace agent
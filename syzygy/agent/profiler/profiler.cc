@@ -330,7 +330,17 @@ class Profiler::ThreadState
  private:
   friend class Profiler;
 
-  void RecordInvocation(RetAddr caller, FuncAddr function, uint64_t cycles);
+  void RecordInvocation(RetAddr caller,
+                        FuncAddr function,
+                        uint64_t cycles,
+                        uint32_t weight);
+
+  // Counts a call, and decides whether it's timed when sampling.
+  // @param cycles the time of the call.
+  // @param weight receives the number of calls the call stands for, if it's
+  //     timed.
+  // @returns true if the call is timed, false if it's only counted.
+  bool SampleCall(uint64_t cycles, uint32_t* weight);
 
   void UpdateOverhead(uint64_t entry_cycles);
   InvocationInfo* AllocateInvocationInfo();
@@ -357,12 +367,25 @@ class Profiler::ThreadState
 
   // The set of modules we've logged.
   ModuleSet logged_modules_;
+
+  // @name Sampling state.
+  // @{
+  // The number of calls left until the next one is timed.
+  uint32_t calls_until_sample_;
+  // The number of calls since the last timed call.
+  uint32_t calls_since_sample_;
+  // The time of the last timed call.
+  uint64_t last_sample_cycles_;
+  // @}
 };
 
 Profiler::ThreadState::ThreadState(Profiler* profiler)
     : profiler_(profiler),
       cycles_overhead_(0LL),
-      batch_(NULL) {
+      batch_(NULL),
+      calls_until_sample_(profiler->parameters_.sampling_interval),
+      calls_since_sample_(0),
+      last_sample_cycles_(0) {
   Initialize();
 }
 
@@ -460,6 +483,11 @@ void Profiler::ThreadState::OnFunctionEntry(EntryFrame* entry_frame,
   if (profiler_->session_.IsDisabled())
     return;
 
+  // Calls that aren't sampled are only counted, so that they're cheap.
+  uint32_t weight = 0;
+  if (!SampleCall(cycles, &weight))
+    return;
+
   // Record the details of the entry.
   // Note that on tail-recursion and tail-call elimination, the caller recorded
   // here will be a thunk. We cater for this case on exit as best we can.
@@ -468,6 +496,7 @@ void Profiler::ThreadState::OnFunctionEntry(EntryFrame* entry_frame,
   data->caller = entry_frame->retaddr;
   data->function = function;
   data->cycles_entry = cycles - cycles_overhead_;
+  data->weight = weight;
 
   entry_frame->retaddr = data->thunk;
 
@@ -480,6 +509,10 @@ void Profiler::ThreadState::OnV8FunctionEntry(FuncAddr function,
   if (profiler_->session_.IsDisabled())
     return;
 
+  uint32_t weight = 0;
+  if (!SampleCall(cycles, &weight))
+    return;
+
   // Record the details of the entry.
 
   // TODO(siggi): Note that we want to do different exit processing here,
@@ -493,6 +526,7 @@ void Profiler::ThreadState::OnV8FunctionEntry(FuncAddr function,
   data->caller = *return_address_location;
   data->function = function;
   data->cycles_entry = cycles - cycles_overhead_;
+  data->weight = weight;
 
   *return_address_location = data->thunk;
 
@@ -514,10 +548,12 @@ void Profiler::ThreadState::OnFunctionExit(const ThunkData* data,
   //     on a cache hit.
   Thunk* ret_thunk = CastToThunk(data->caller);
   if (ret_thunk == NULL) {
-    RecordInvocation(data->caller, data->function, cycles_executed);
+    RecordInvocation(data->caller, data->function, cycles_executed,
+                     data->weight);
   } else {
     ThunkData* ret_data = DataFromThunk(ret_thunk);
-    RecordInvocation(ret_data->function, data->function, cycles_executed);
+    RecordInvocation(ret_data->function, data->function, cycles_executed,
+                     data->weight);
   }
 
   UpdateOverhead(cycles_exit);
@@ -531,9 +567,31 @@ void Profiler::ThreadState::OnPageRemoved(const void* page) {
   profiler_->OnPageRemoved(page);
 }
 
+bool Profiler::ThreadState::SampleCall(uint64_t cycles, uint32_t* weight) {
+  DCHECK(weight != NULL);
+
+  ++calls_since_sample_;
+
+  const Parameters& parameters = profiler_->parameters_;
+  if (parameters.sampling_interval == 0 || --calls_until_sample_ != 0) {
+    if (parameters.sampling_cycles == 0 ||
+        cycles - last_sample_cycles_ < parameters.sampling_cycles) {
+      return false;
+    }
+  }
+
+  // This call stands for those skipped since the last one timed.
+  *weight = calls_since_sample_;
+  calls_since_sample_ = 0;
+  calls_until_sample_ = parameters.sampling_interval;
+  last_sample_cycles_ = cycles;
+  return true;
+}
+
 void Profiler::ThreadState::RecordInvocation(RetAddr caller,
                                              FuncAddr function,
-                                             uint64_t duration_cycles) {
+                                             uint64_t duration_cycles,
+                                             uint32_t weight) {
   // See whether we've already recorded an entry for this function.
   InvocationKey key(caller, function);
   InvocationMap::iterator it = invocations_.find(key);
@@ -545,9 +603,11 @@ void Profiler::ThreadState::RecordInvocation(RetAddr caller,
          value.caller_symbol->move_count() == value.caller_move_count) &&
         (value.function_symbol == NULL ||
          value.function_symbol->move_count() == value.function_move_count)) {
-      // The entry is still good, tally the new data.
-      ++(value.info->num_calls);
-      value.info->cycles_sum += duration_cycles;
+      // The entry is still good, tally the new data. When sampling, the
+      // invocation is scaled to the calls it stands for, while the extremes
+      // are those of the invocations timed.
+      value.info->num_calls += weight;
+      value.info->cycles_sum += duration_cycles * weight;
       if (duration_cycles < value.info->cycles_min) {
         value.info->cycles_min = duration_cycles;
       } else if (duration_cycles > value.info->cycles_max) {
@@ -634,8 +694,9 @@ void Profiler::ThreadState::RecordInvocation(RetAddr caller,
           reinterpret_cast<const uint8_t*>(caller_symbol->address());
     }
 
-    info->num_calls = 1;
-    info->cycles_min = info->cycles_max = info->cycles_sum = duration_cycles;
+    info->num_calls = weight;
+    info->cycles_min = info->cycles_max = duration_cycles;
+    info->cycles_sum = duration_cycles * weight;
   }
 }
 
@@ -833,6 +894,17 @@ void Profiler::OnDllEvent(agent::common::DllNotificationWatcher::EventType type,
 }
 
 Profiler::Profiler() : handler_registration_(NULL) {
+  // The parameters are read before the first thread state is created, as it
+  // samples according to them. If they fail to parse, every call is timed.
+  SetDefaultParameters(&parameters_);
+  if (!ParseParametersFromEnv(&parameters_))
+    SetDefaultParameters(&parameters_);
+  if (parameters_.sampling_interval != 1 || parameters_.sampling_cycles != 0) {
+    LOG(INFO) << "Sampling every " << parameters_.sampling_interval
+              << " calls and every " << parameters_.sampling_cycles
+              << " cycles.";
+  }
+
   // Create our RPC session and allocate our initial trace segment on creation,
   // aka at load time.
   ThreadState* data = CreateFirstThreadStateAndSession();
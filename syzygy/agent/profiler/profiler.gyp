@@ -21,6 +21,8 @@
       'target_name': 'profile_lib',
       'type': 'static_library',
       'sources': [
+        'parameters.cc',
+        'parameters.h',
         'return_thunk_factory.cc',
         'return_thunk_factory.h',
         'symbol_map.cc',
@@ -51,6 +53,7 @@
       'target_name': 'profile_unittests',
       'type': 'executable',
       'sources': [
+        'parameters_unittest.cc',
         'profiler_unittest.cc',
         'return_thunk_factory_unittest.cc',
         'symbol_map_unittest.cc',
@@ -33,6 +33,7 @@
 #include "syzygy/agent/common/dll_notifications.h"
 #include "syzygy/agent/common/entry_frame.h"
 #include "syzygy/agent/common/thread_state.h"
+#include "syzygy/agent/profiler/parameters.h"
 #include "syzygy/agent/profiler/symbol_map.h"
 #include "syzygy/trace/client/rpc_session.h"
 
@@ -142,6 +143,10 @@ class Profiler {
   // The RPC session we're logging to/through.
   trace::client::RpcSession session_;
 
+  // The runtime parameters of the profiler, which are read from the
+  // environment on creation.
+  Parameters parameters_;
+
   // Protects pages_ and logged_modules_.
   base::Lock lock_;
 
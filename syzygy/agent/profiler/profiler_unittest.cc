@@ -19,8 +19,10 @@
 #include <psapi.h>
 
 #include <limits>
+#include <memory>
 
 #include "base/bind.h"
+#include "base/environment.h"
 #include "base/scoped_native_library.h"
 #include "base/files/file_enumerator.h"
 #include "base/files/file_util.h"
@@ -30,6 +32,7 @@
 #include "base/threading/thread.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/agent/profiler/parameters.h"
 #include "syzygy/common/process_utils.h"
 #include "syzygy/core/unittest_util.h"
 #include "syzygy/pe/unittest_util.h"
@@ -145,6 +148,10 @@ MATCHER_P2(InvocationInfoHasCallerSymbol, symbol_id, symbol_len, "") {
   return false;
 }
 
+MATCHER_P(InvocationInfoHasNumCalls, num_calls, "") {
+  return arg->invocations[0].num_calls == num_calls;
+}
+
 MATCHER_P(InvocationInfoHasFunctionSymbol, symbol_id, "") {
   for (size_t i = 0; i < 1; ++i) {
     const InvocationInfo& invocation = arg->invocations[i];
@@ -192,6 +199,9 @@ class ProfilerTest : public testing::Test {
 
     UnloadDll();
 
+    std::unique_ptr<base::Environment> env(base::Environment::Create());
+    env->UnSetVar(kParametersEnvVar);
+
     // Stop the call trace service.
     service_.Stop();
   }
@@ -565,6 +575,44 @@ TEST_F(ProfilerTest, RecordsOneEntryPerModuleAndFunction) {
   ASSERT_NO_FATAL_FAILURE(ReplayLogs());
 }
 
+TEST_F(ProfilerTest, SamplesFunctionEntries) {
+  // Time every other call.
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  ASSERT_TRUE(env->SetVar(kParametersEnvVar, "--sampling-interval=2"));
+
+  ASSERT_NO_FATAL_FAILURE(StartService());
+  HMODULE self_module = ::GetModuleHandle(NULL);
+  ASSERT_NO_FATAL_FAILURE(LoadDll());
+
+  // The module entry is the first call, which is only counted. The second
+  // and fourth invocations of Function A are timed, each standing for two
+  // calls.
+  EXPECT_NO_FATAL_FAILURE(InvokeDllMainThunk(self_module));
+  for (size_t i = 0; i < 4; ++i)
+    ASSERT_NO_FATAL_FAILURE(InvokeFunctionAThunk());
+
+  ModuleVector modules;
+  GetCurrentProcessModules(&modules);
+
+  ASSERT_NO_FATAL_FAILURE(UnloadDll());
+
+  EXPECT_CALL(handler_, OnProcessStarted(_, ::GetCurrentProcessId(), _));
+  for (size_t i = 0; i < modules.size(); ++i) {
+    EXPECT_CALL(handler_, OnProcessAttach(_,
+                                          ::GetCurrentProcessId(),
+                                          ::GetCurrentThreadId(),
+                                          ModuleAtAddress(modules[i])));
+  }
+  EXPECT_CALL(handler_, OnInvocationBatch(_,
+                                          ::GetCurrentProcessId(),
+                                          ::GetCurrentThreadId(),
+                                          1,
+                                          InvocationInfoHasNumCalls(4)));
+  EXPECT_CALL(handler_, OnProcessEnded(_, ::GetCurrentProcessId()));
+
+  ASSERT_NO_FATAL_FAILURE(ReplayLogs());
+}
+
 TEST_F(ProfilerTest, RecordsThreadName) {
   if (::IsDebuggerPresent()) {
     LOG(WARNING) << "This test fails under debugging.";
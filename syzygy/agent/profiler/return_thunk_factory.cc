@@ -14,13 +14,121 @@
 
 #include "syzygy/agent/profiler/return_thunk_factory.h"
 
+#include <vector>
+
+#include "base/lazy_instance.h"
 #include "base/logging.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/assm/assembler.h"
 #include "syzygy/assm/buffer_serializer.h"
 
 namespace agent {
 namespace profiler {
 
+namespace {
+
+// A process-wide pool of thunk pages. The pages are committed from a single
+// reserved region, so that telling a thunk from any other return address
+// takes a range check.
+class ThunkPagePool {
+ public:
+  // The size of the region, good for about 3 million thunks.
+  static const size_t kRegionSize = 32 * 1024 * 1024;
+
+  // The number of free pages kept committed. Past that, freed pages are
+  // decommitted.
+  static const size_t kMaxFreePages = 256;
+
+  static const size_t kPageSize = 0x00001000;
+
+  ThunkPagePool() : next_page_(0) {
+    region_ = reinterpret_cast<uint8_t*>(::VirtualAlloc(
+        NULL, kRegionSize, MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+    CHECK(region_ != NULL);
+  }
+
+  // Allocates a page.
+  // @param is_new receives true if the page is freshly committed, or false
+  //     if it was used before and still holds its thunks.
+  // @returns the page.
+  void* AllocatePage(bool* is_new) {
+    DCHECK(is_new != NULL);
+
+    base::AutoLock lock(lock_);
+    if (!free_pages_.empty()) {
+      void* page = free_pages_.back();
+      free_pages_.pop_back();
+      *is_new = false;
+      return page;
+    }
+
+    void* page = NULL;
+    if (!decommitted_pages_.empty()) {
+      page = decommitted_pages_.back();
+      decommitted_pages_.pop_back();
+    } else {
+      CHECK_LT(next_page_, kRegionSize / kPageSize)
+          << "Ran out of thunk pages.";
+      page = region_ + next_page_ * kPageSize;
+      ++next_page_;
+    }
+
+    page = ::VirtualAlloc(page, kPageSize, MEM_COMMIT,
+                          PAGE_EXECUTE_READWRITE);
+    CHECK(page != NULL);
+    *is_new = true;
+    return page;
+  }
+
+  // Keeps @p page for reuse, if there's room for it.
+  // @returns true if the page is kept, false if the caller must release it
+  //     with DecommitPage.
+  bool FreePage(void* page) {
+    DCHECK(Contains(page));
+
+    base::AutoLock lock(lock_);
+    if (free_pages_.size() >= kMaxFreePages)
+      return false;
+    free_pages_.push_back(page);
+    return true;
+  }
+
+  // Decommits @p page, whose thunks must no longer be used.
+  void DecommitPage(void* page) {
+    DCHECK(Contains(page));
+
+    CHECK(::VirtualFree(page, kPageSize, MEM_DECOMMIT));
+    base::AutoLock lock(lock_);
+    decommitted_pages_.push_back(page);
+  }
+
+  // @returns true if @p address lies in the region of the pool.
+  bool Contains(const void* address) const {
+    const uint8_t* addr = reinterpret_cast<const uint8_t*>(address);
+    return addr >= region_ && addr < region_ + kRegionSize;
+  }
+
+ private:
+  // The reserved region, which is never released.
+  uint8_t* region_;
+
+  base::Lock lock_;
+  // The committed pages that are free.
+  std::vector<void*> free_pages_;  // Under lock_.
+  // The pages that were decommitted, for reuse before new ones.
+  std::vector<void*> decommitted_pages_;  // Under lock_.
+  // The index of the next page of the region that was never committed.
+  size_t next_page_;  // Under lock_.
+
+  DISALLOW_COPY_AND_ASSIGN(ThunkPagePool);
+};
+
+// The pool outlives all factories, as thread teardown may run late.
+base::LazyInstance<ThunkPagePool>::Leaky thunk_page_pool =
+    LAZY_INSTANCE_INITIALIZER;
+
+}  // namespace
+
 ReturnThunkFactoryBase::ReturnThunkFactoryBase(ThunkMainFunc main_func)
     : main_func_(main_func),
       first_free_thunk_(NULL) {
@@ -47,16 +155,7 @@ void ReturnThunkFactoryBase::Uninitialize() {
   while (current_page) {
     Page* page_to_free = current_page;
     current_page = current_page->next_page;
-
-    // Notify our subclasses of the release.
-    // We do this before freeing the memory to make sure we don't
-    // open a race where a new thread could sneak a stack into
-    // the page allocation.
-    OnPageRemoved(page_to_free);
-
-    ThunkData* data = DataFromThunk(&page_to_free->thunks[0]);
-    delete [] data;
-    ::VirtualFree(page_to_free, 0, MEM_RELEASE);
+    FreePage(page_to_free);
   }
 
   first_free_thunk_ = NULL;
@@ -83,15 +182,15 @@ ReturnThunkFactoryBase::ThunkData* ReturnThunkFactoryBase::MakeThunk(
 ReturnThunkFactoryBase::Thunk* ReturnThunkFactoryBase::CastToThunk(
     RetAddr ret) {
   Thunk* thunk = const_cast<Thunk*>(reinterpret_cast<const Thunk*>(ret));
-  Page* thunk_page = PageFromThunk(thunk);
-  Page* page = PageFromThunk(first_free_thunk_);
+  if (!thunk_page_pool.Get().Contains(thunk))
+    return NULL;
 
-  for (; page != NULL; page = page->previous_page) {
-    if (page == thunk_page)
-      return thunk;
-  }
+  // A return address in the region is a live thunk, whose page is committed
+  // and owned by the factory of the thread it was made on.
+  if (PageFromThunk(thunk)->factory != this)
+    return NULL;
 
-  return NULL;
+  return thunk;
 }
 
 // static.
@@ -104,16 +203,19 @@ void ReturnThunkFactoryBase::AddPage() {
   Page* previous_page = PageFromThunk(first_free_thunk_);
   DCHECK(previous_page == NULL || previous_page->next_page == NULL);
 
-  // TODO(joi): This may be consuming 64K of memory, in which case it would
-  // be more efficient to reserve a larger block at a time if we think we
-  // normally need more than 4K of thunks.
-  Page* new_page = reinterpret_cast<Page*>(::VirtualAlloc(
-      NULL, kPageSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
-  CHECK(new_page != NULL);
+  bool is_new = false;
+  Page* new_page = reinterpret_cast<Page*>(
+      thunk_page_pool.Get().AllocatePage(&is_new));
 
-  // Allocate the data associated with each thunk.
-  ThunkData* data = new ThunkData[kNumThunksPerPage];
-  CHECK(data != NULL);
+  // A page from the pool keeps the data of its thunks, but may have been
+  // generated for another factory.
+  ThunkData* data = NULL;
+  if (is_new) {
+    data = new ThunkData[kNumThunksPerPage];
+    CHECK(data != NULL);
+  } else {
+    data = DataFromThunk(&new_page->thunks[0]);
+  }
 
   // Insert the page into our page list.
   new_page->previous_page = previous_page;
@@ -123,14 +225,26 @@ void ReturnThunkFactoryBase::AddPage() {
   if (previous_page)
     previous_page->next_page = new_page;
 
+  InitializePage(new_page, data);
+
+  first_free_thunk_ = &new_page->thunks[0];
+
+  // Notify subclass that the page has been allocated.
+  OnPageAdded(new_page);
+}
+
+void ReturnThunkFactoryBase::InitializePage(Page* page, ThunkData* data) {
+  DCHECK(page != NULL);
+  DCHECK(data != NULL);
+
   typedef assm::AssemblerImpl::Immediate Immediate;
   typedef assm::AssemblerImpl Assembler;
   using assm::kSize32Bit;
 
   // Initialize the thunks.
-  uint32_t start_addr = reinterpret_cast<uint32_t>(&new_page->thunks[0]);
+  uint32_t start_addr = reinterpret_cast<uint32_t>(&page->thunks[0]);
   assm::BufferSerializer serializer(
-      reinterpret_cast<uint8_t*>(new_page->thunks),
+      reinterpret_cast<uint8_t*>(page->thunks),
       kNumThunksPerPage * sizeof(Thunk));
   Assembler assm(start_addr, &serializer);
   for (size_t i = 0; i < kNumThunksPerPage; ++i) {
@@ -139,7 +253,7 @@ void ReturnThunkFactoryBase::AddPage() {
     DCHECK_GE((kNumThunksPerPage - 1) * sizeof(Thunk),
               assm.location() - start_addr);
     // Set data up to point to thunk.
-    data[i].thunk = &new_page->thunks[i];
+    data[i].thunk = &page->thunks[i];
     data[i].self = this;
 
     // Note that the size of the thunk must match the assembly code below.
@@ -150,11 +264,40 @@ void ReturnThunkFactoryBase::AddPage() {
     assm.push(Immediate(reinterpret_cast<uint32_t>(&data[i]), kSize32Bit));
     assm.jmp(Immediate(reinterpret_cast<uint32_t>(main_func_), kSize32Bit));
   }
+}
 
-  first_free_thunk_ = &new_page->thunks[0];
+void ReturnThunkFactoryBase::TrimSparePages() {
+  Page* page = PageFromThunk(first_free_thunk_);
+  for (size_t i = 0; i < kMaxSparePages && page->next_page != NULL; ++i)
+    page = page->next_page;
+
+  Page* spare_page = page->next_page;
+  page->next_page = NULL;
+  while (spare_page != NULL) {
+    Page* page_to_free = spare_page;
+    spare_page = spare_page->next_page;
+    FreePage(page_to_free);
+  }
+}
 
-  // Notify subclass that the page has been allocated.
-  OnPageAdded(new_page);
+void ReturnThunkFactoryBase::FreePage(Page* page) {
+  DCHECK(page != NULL);
+
+  // Notify our subclasses of the release.
+  // We do this before freeing the memory to make sure we don't
+  // open a race where a new thread could sneak a stack into
+  // the page allocation.
+  OnPageRemoved(page);
+
+  page->previous_page = NULL;
+  page->next_page = NULL;
+  page->factory = NULL;
+  if (thunk_page_pool.Get().FreePage(page))
+    return;
+
+  ThunkData* data = DataFromThunk(&page->thunks[0]);
+  delete [] data;
+  thunk_page_pool.Get().DecommitPage(page);
 }
 
 // static
@@ -22,10 +22,12 @@ namespace agent {
 namespace profiler {
 
 // A factory for return thunks as used by the profiler.  These are
-// packed as tight as possible into whole pages of memory.  All pages
-// are freed on destruction, but currently-unused pages are not freed
-// in between times, on the assumption that the call stack will grow
-// as deep again as it has before.
+// packed as tight as possible into whole pages of memory.  The pages
+// come from a process-wide pool, and go back to it on destruction, so
+// that they're recycled across threads.  A few currently-unused pages
+// are kept in between times, on the assumption that the call stack will
+// grow as deep again as it has before, and the rest go back to the pool
+// as the stack unwinds.
 //
 // This class is currently somewhat specific to profiling, as it
 // calls rdtsc in the return hook and stores data needed for profiling,
@@ -45,7 +47,7 @@ class ReturnThunkFactoryBase {
   ThunkData* MakeThunk(RetAddr real_ret);
 
   // If @p ret is a thunk belonging to this factory, return that thunk,
-  // or NULL otherwise.
+  // or NULL otherwise. This takes constant time.
   Thunk* CastToThunk(RetAddr ret);
 
   // Returns the thunk data corresponding to a thunk.
@@ -77,6 +79,9 @@ class ReturnThunkFactoryBase {
 
     // The time of entry.
     uint64_t cycles_entry;
+
+    // The number of calls this invocation stands for, when sampling.
+    uint32_t weight;
   };
   COMPILE_ASSERT_IS_POD(ThunkData);
 
@@ -121,7 +126,18 @@ class ReturnThunkFactoryBase {
   static const size_t kNumThunksPerPage =
       (kPageSize - offsetof(Page, thunks)) / sizeof(Thunk);
 
+  // The number of unused pages kept past the current one as the stack
+  // unwinds.
+  static const size_t kMaxSparePages = 2;
+
   void AddPage();
+  // Generates the thunks of @p page, which point to @p data.
+  void InitializePage(Page* page, ThunkData* data);
+  // Returns the pages in excess of kMaxSparePages past the current one to
+  // the pool.
+  void TrimSparePages();
+  // Returns @p page to the pool.
+  void FreePage(Page* page);
   static Page* PageFromThunk(Thunk* thunk);
   static Thunk* LastThunk(Page* page);
 
@@ -231,6 +247,10 @@ ReturnThunkFactoryImpl<ImplClass>::ThunkMain(ThunkData* data, uint64_t cycles) {
   ImplClass* factory = static_cast<ImplClass*>(data->self);
   factory->first_free_thunk_ = data->thunk;
 
+  // Returning to the first thunk of a page may leave spare pages behind.
+  if (data->thunk == &PageFromThunk(data->thunk)->thunks[0])
+    factory->TrimSparePages();
+
   factory->OnFunctionExit(data, cycles);
 
   return data->caller;
@@ -44,6 +44,7 @@ class TestFactory : public ReturnThunkFactoryImpl<TestFactory> {
   using ReturnThunkFactoryImpl<TestFactory>::Initialize;
   using ReturnThunkFactoryImpl<TestFactory>::ThunkMain;
   using ReturnThunkFactoryImpl<TestFactory>::kNumThunksPerPage;
+  using ReturnThunkFactoryImpl<TestFactory>::kMaxSparePages;
 };
 
 class ReturnThunkTest : public testing::Test {
@@ -243,6 +244,65 @@ TEST_F(ReturnThunkTest, CastToThunk) {
   ASSERT_EQ(NULL, factory_->CastToThunk(reinterpret_cast<RetAddr>(0x10)));
 }
 
+TEST_F(ReturnThunkTest, CastToThunkOfAnotherFactory) {
+  StrictMock<TestFactory> other_factory;
+  EXPECT_CALL(other_factory, OnPageAdded(_));
+  other_factory.Initialize();
+
+  ReturnThunkFactoryBase::ThunkData* data = other_factory.MakeThunk(NULL);
+  EXPECT_EQ(data->thunk, other_factory.CastToThunk(data->thunk));
+  EXPECT_EQ(NULL, factory_->CastToThunk(data->thunk));
+
+  EXPECT_CALL(other_factory, OnPageRemoved(_));
+}
+
+TEST_F(ReturnThunkTest, RecyclesPages) {
+  const void* page =
+      TestFactory::PageFromThunk(factory_->MakeThunk(NULL)->thunk);
+  EXPECT_CALL(*factory_, OnPageRemoved(page));
+  delete factory_;
+  factory_ = NULL;
+
+  // A new factory picks up the page that was freed, and makes thunks of its
+  // own with it.
+  StrictMock<TestFactory> new_factory;
+  EXPECT_CALL(new_factory, OnPageAdded(page));
+  new_factory.Initialize();
+
+  ReturnThunkFactoryBase::ThunkData* data = new_factory.MakeThunk(NULL);
+  EXPECT_EQ(page, TestFactory::PageFromThunk(data->thunk));
+  EXPECT_EQ(&new_factory, data->self);
+  EXPECT_EQ(data->thunk, new_factory.CastToThunk(data->thunk));
+
+  EXPECT_CALL(new_factory, OnFunctionExit(data, _));
+  TestFactory::ThunkMain(data, 0LL);
+
+  EXPECT_CALL(new_factory, OnPageRemoved(page));
+}
+
+TEST_F(ReturnThunkTest, TrimsSparePages) {
+  ReturnThunkFactoryBase::ThunkData* first_thunk = factory_->MakeThunk(NULL);
+
+  // Grow the stack by a few more pages than are kept spare.
+  const size_t kNumPages = TestFactory::kMaxSparePages + 3;
+  EXPECT_CALL(*factory_, OnPageAdded(_)).Times(kNumPages);
+  for (size_t i = 0; i < kNumPages * TestFactory::kNumThunksPerPage; ++i)
+    factory_->MakeThunk(NULL);
+
+  // Unwinding past the page boundary releases the pages in excess of the
+  // spare ones.
+  EXPECT_CALL(*factory_, OnPageRemoved(_)).Times(3);
+  EXPECT_CALL(*factory_, OnFunctionExit(_, _));
+  TestFactory::ThunkMain(first_thunk, 0LL);
+  testing::Mock::VerifyAndClearExpectations(factory_);
+
+  // The spare pages are reused as the stack grows again.
+  for (size_t i = 0;
+       i < TestFactory::kMaxSparePages * TestFactory::kNumThunksPerPage; ++i) {
+    factory_->MakeThunk(NULL);
+  }
+}
+
 TEST_F(ReturnThunkTest, ReturnPreservesRegisters) {
   EXPECT_CALL(*factory_, OnFunctionExit(_, _));
 
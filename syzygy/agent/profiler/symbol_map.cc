@@ -14,15 +14,58 @@
 
 #include "syzygy/agent/profiler/symbol_map.h"
 
+#include <algorithm>
+
+#include "base/threading/platform_thread.h"
+
 namespace agent {
 namespace profiler {
 
+namespace {
+
+// Registers a lookup in the current epoch for its lifetime, so that the
+// snapshot it reads isn't freed under it.
+class ScopedEpochReader {
+ public:
+  ScopedEpochReader(base::subtle::Atomic32* epoch,
+                    base::subtle::Atomic32* readers)
+      : readers_(readers) {
+    // The epoch may flip between reading it and registering, in which case
+    // the writer may not wait for us, so we register again.
+    while (true) {
+      epoch_ = base::subtle::Acquire_Load(epoch);
+      base::subtle::Barrier_AtomicIncrement(&readers_[epoch_], 1);
+      if (base::subtle::Acquire_Load(epoch) == epoch_)
+        break;
+      base::subtle::Barrier_AtomicIncrement(&readers_[epoch_], -1);
+    }
+  }
+
+  ~ScopedEpochReader() {
+    base::subtle::Barrier_AtomicIncrement(&readers_[epoch_], -1);
+  }
+
+ private:
+  base::subtle::Atomic32* readers_;
+  base::subtle::Atomic32 epoch_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedEpochReader);
+};
+
+}  // namespace
+
 base::subtle::Atomic32 SymbolMap::Symbol::next_symbol_id_ = 0;
 
-SymbolMap::SymbolMap() {
+const size_t SymbolMap::kPublishBatchSize;
+
+SymbolMap::SymbolMap()
+    : pending_updates_(0), snapshot_(0), epoch_(0) {
+  readers_[0] = 0;
+  readers_[1] = 0;
 }
 
 SymbolMap::~SymbolMap() {
+  delete reinterpret_cast<Snapshot*>(snapshot_);
 }
 
 void SymbolMap::AddSymbol(const void* start_addr,
@@ -41,6 +84,8 @@ void SymbolMap::AddSymbol(const void* start_addr,
   bool inserted = addr_space_.Insert(
       Range(reinterpret_cast<const uint8_t*>(start_addr), length), symbol);
   DCHECK(inserted);
+
+  UpdatedUnlocked();
 }
 
 void SymbolMap::MoveSymbol(const void* old_addr, const void* new_addr) {
@@ -69,18 +114,114 @@ void SymbolMap::MoveSymbol(const void* old_addr, const void* new_addr) {
   bool inserted = addr_space_.Insert(
       Range(reinterpret_cast<const uint8_t*>(new_addr), length), symbol);
   DCHECK(inserted);
+
+  UpdatedUnlocked();
 }
 
 scoped_refptr<SymbolMap::Symbol> SymbolMap::FindSymbol(const void* addr) {
+  scoped_refptr<Symbol> symbol;
+  if (FindSymbolInSnapshot(addr, &symbol))
+    return symbol;
+
+  // The snapshot is stale, so search the address space and publish it for
+  // the lookups to come.
   base::AutoLock hold(lock_);
 
   SymbolAddressSpace::RangeMapIter found = addr_space_.FindFirstIntersection(
       Range(reinterpret_cast<const uint8_t*>(addr), 1));
+  if (found != addr_space_.end())
+    symbol = found->second;
+
+  if (base::subtle::NoBarrier_Load(&pending_updates_) != 0)
+    PublishUnlocked();
+
+  return symbol;
+}
+
+void SymbolMap::Publish() {
+  base::AutoLock hold(lock_);
+  if (base::subtle::NoBarrier_Load(&pending_updates_) != 0)
+    PublishUnlocked();
+}
+
+bool SymbolMap::FindSymbolInSnapshot(const void* addr,
+                                     scoped_refptr<Symbol>* symbol) {
+  DCHECK(symbol != NULL);
+
+  // The pending updates are read first. If there are none, the snapshot read
+  // next is at least as recent as the updates made so far, so that whatever
+  // it misses isn't in the address space either.
+  bool pending = base::subtle::Acquire_Load(&pending_updates_) != 0;
+
+  ScopedEpochReader reader(&epoch_, readers_);
+  const Snapshot* snapshot = reinterpret_cast<const Snapshot*>(
+      base::subtle::Acquire_Load(&snapshot_));
+  if (snapshot == NULL)
+    return !pending;
+
+  // Find the last symbol starting at or before addr.
+  const uint8_t* address = reinterpret_cast<const uint8_t*>(addr);
+  Snapshot::const_iterator it = std::upper_bound(
+      snapshot->begin(), snapshot->end(), address,
+      [](const uint8_t* address, const SnapshotEntry& entry) {
+        return address < entry.start;
+      });
+  if (it == snapshot->begin() ||
+      static_cast<size_t>(address - (it - 1)->start) >= (it - 1)->size) {
+    // Symbols added since the snapshot may cover the address.
+    return !pending;
+  }
+  --it;
+
+  // A symbol that moved or was retired since the snapshot may be covered by
+  // another one by now. Otherwise, the symbol still covers the address, as
+  // symbols added over it would have retired it.
+  if (it->symbol->move_count() != it->move_count)
+    return false;
+
+  *symbol = it->symbol;
+  return true;
+}
+
+void SymbolMap::UpdatedUnlocked() {
+  lock_.AssertAcquired();
+
+  base::subtle::Atomic32 pending_updates =
+      base::subtle::NoBarrier_AtomicIncrement(&pending_updates_, 1);
+  if (static_cast<size_t>(pending_updates) >= kPublishBatchSize)
+    PublishUnlocked();
+}
+
+void SymbolMap::PublishUnlocked() {
+  lock_.AssertAcquired();
+
+  Snapshot* snapshot = new Snapshot();
+  snapshot->reserve(addr_space_.size());
+  SymbolAddressSpace::iterator it = addr_space_.begin();
+  for (; it != addr_space_.end(); ++it) {
+    SnapshotEntry entry = { it->first.start(), it->first.size(), it->second,
+                            it->second->move_count() };
+    snapshot->push_back(entry);
+  }
+
+  // The updates are published before they're no longer counted as pending,
+  // so that lookups missing them fall back to the address space meanwhile.
+  Snapshot* old_snapshot = reinterpret_cast<Snapshot*>(
+      base::subtle::NoBarrier_Load(&snapshot_));
+  base::subtle::Release_Store(&snapshot_,
+                              reinterpret_cast<base::subtle::AtomicWord>(
+                                  snapshot));
+  base::subtle::Release_Store(&pending_updates_, 0);
 
-  if (found == addr_space_.end())
-    return NULL;
+  // Lookups registering in the new epoch see the new snapshot, so the old one
+  // can be freed once those of the old epoch have left.
+  base::subtle::Atomic32 old_epoch = base::subtle::NoBarrier_Load(&epoch_);
+  base::subtle::Release_Store(&epoch_, old_epoch ^ 1);
+  base::subtle::MemoryBarrier();
+  while (base::subtle::Acquire_Load(&readers_[old_epoch]) != 0)
+    base::PlatformThread::YieldCurrentThread();
 
-  return found->second;
+  delete old_snapshot;
 }
 
 void SymbolMap::RetireRangeUnlocked(const Range& range) {
@@ -15,8 +15,9 @@
 #ifndef SYZYGY_AGENT_PROFILER_SYMBOL_MAP_H_
 #define SYZYGY_AGENT_PROFILER_SYMBOL_MAP_H_
 
-#include "base/atomicops.h"
+#include <vector>
 
+#include "base/atomicops.h"
 #include "base/memory/ref_counted.h"
 #include "base/strings/string_piece.h"
 #include "base/synchronization/lock.h"
@@ -29,6 +30,13 @@ namespace profiler {
 // resolving addresses of dynamically generated, garbage collected code, to
 // names in a profiler. This is geared to allow entry/exit processing in a
 // profiler to execute as quickly as possible.
+//
+// Updates are made to an address space under a lock, and are published in
+// batches as immutable, sorted snapshots of it. Lookups search the current
+// snapshot without taking the lock, and only fall back to the address space
+// when the snapshot may be stale for the address looked up. Snapshots are
+// retired with a pair of epoch reader counts: a snapshot is freed once every
+// lookup that may be reading it has left.
 class SymbolMap {
  public:
   class Symbol;
@@ -54,17 +62,65 @@ class SymbolMap {
   // @returns the symbol covering @p addr, if any, or NULL otherwise.
   scoped_refptr<Symbol> FindSymbol(const void* addr);
 
+  // Publishes the updates made since the last snapshot, if any.
+  void Publish();
+
+  // The number of updates made before they're published.
+  static const size_t kPublishBatchSize = 32;
+
  protected:
   typedef core::AddressSpace<const uint8_t*, size_t, scoped_refptr<Symbol>>
       SymbolAddressSpace;
   typedef SymbolAddressSpace::Range Range;
 
+  // A symbol of a snapshot, and its move count as of the snapshot.
+  struct SnapshotEntry {
+    const uint8_t* start;
+    size_t size;
+    scoped_refptr<Symbol> symbol;
+    int32_t move_count;
+  };
+  // An immutable snapshot of the address space, sorted by address.
+  typedef std::vector<SnapshotEntry> Snapshot;
+
+  // Looks up @p addr in the current snapshot, without taking the lock.
+  // @param addr an address to query.
+  // @param symbol receives the symbol covering @p addr, or NULL if the
+  //     snapshot has none.
+  // @returns true if the snapshot is current for @p addr, false if the
+  //     address space must be searched instead.
+  bool FindSymbolInSnapshot(const void* addr, scoped_refptr<Symbol>* symbol);
+
+  // Notes an update of the address space, publishing it if the batch is full.
+  void UpdatedUnlocked();
+
+  // Publishes a new snapshot of the address space, and frees the previous one
+  // once no lookups may be reading it.
+  void PublishUnlocked();
+
   // Retire any symbols overlapping @p range.
   void RetireRangeUnlocked(const Range& range);
 
   base::Lock lock_;
   SymbolAddressSpace addr_space_;  // Under lock_.
 
+  // The number of updates of addr_space_ not yet published. This is written
+  // under lock_, but read without it.
+  base::subtle::Atomic32 pending_updates_;
+
+  // The current snapshot, a Snapshot*. This is written under lock_, but read
+  // without it.
+  base::subtle::AtomicWord snapshot_;
+
+  // @name Retirement of snapshots.
+  // @{
+  // The parity of the current epoch, which lookups register in. This is
+  // flipped under lock_ as a snapshot is replaced.
+  base::subtle::Atomic32 epoch_;
+  // The number of lookups in progress in each epoch.
+  base::subtle::Atomic32 readers_[2];
+  // @}
+
  private:
   DISALLOW_COPY_AND_ASSIGN(SymbolMap);
 };
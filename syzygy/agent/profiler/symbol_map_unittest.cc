@@ -14,6 +14,11 @@
 
 #include "syzygy/agent/profiler/symbol_map.h"
 
+#include <memory>
+#include <vector>
+
+#include "base/strings/string_number_conversions.h"
+#include "base/threading/simple_thread.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -27,6 +32,16 @@ class TestingSymbolMap : public SymbolMap {
   // Expose the address space for testing.
   using SymbolMap::addr_space_;
   typedef SymbolMap::SymbolAddressSpace SymbolAddressSpace;
+
+  // Expose the publication state for testing.
+  size_t pending_updates() const {
+    return base::subtle::Acquire_Load(&pending_updates_);
+  }
+  size_t snapshot_size() const {
+    const Snapshot* snapshot = reinterpret_cast<const Snapshot*>(
+        base::subtle::Acquire_Load(&snapshot_));
+    return snapshot == NULL ? 0 : snapshot->size();
+  }
 };
 
 const uint8_t* ToPtr(intptr_t number) {
@@ -38,6 +53,39 @@ class SymbolMapTest : public testing::Test {
   TestingSymbolMap symbol_map_;
 };
 
+// The symbols of the concurrency test are named after their index, and move
+// back and forth between two regions, at the same offset in each.
+const size_t kNumSymbols = 100;
+const intptr_t kRegions[] = { 0x100000, 0x800000 };
+const intptr_t kSymbolSpacing = 0x100;
+const size_t kSymbolLength = 0x10;
+
+// Looks up the symbols of the concurrency test, checking that the symbols
+// found are those expected at the addresses looked up.
+class SymbolLookupThread : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit SymbolLookupThread(SymbolMap* symbol_map)
+      : symbol_map_(symbol_map), mismatches_(0) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < 100000; ++i) {
+      size_t index = i % kNumSymbols;
+      intptr_t offset = index * kSymbolSpacing + i % kSymbolLength;
+      scoped_refptr<SymbolMap::Symbol> symbol = symbol_map_->FindSymbol(
+          ToPtr(kRegions[i % arraysize(kRegions)] + offset));
+      if (symbol != NULL && symbol->name() != base::SizeTToString(index))
+        ++mismatches_;
+    }
+  }
+
+  size_t mismatches() const { return mismatches_; }
+
+ private:
+  SymbolMap* symbol_map_;
+  size_t mismatches_;
+};
+
 }  // namespace
 
 TEST_F(SymbolMapTest, AddSymbol) {
@@ -175,5 +223,103 @@ TEST_F(SymbolMapTest, SymbolLifeCycle) {
   EXPECT_EQ(ToPtr(NULL), symbol->address());
 }
 
+TEST_F(SymbolMapTest, PublishesInBatches) {
+  // Updates aren't published until the batch is full.
+  for (size_t i = 0; i < SymbolMap::kPublishBatchSize - 1; ++i)
+    symbol_map_.AddSymbol(ToPtr(0x1000 + i * 0x100), 0x10, "foo");
+  EXPECT_EQ(SymbolMap::kPublishBatchSize - 1, symbol_map_.pending_updates());
+  EXPECT_EQ(0u, symbol_map_.snapshot_size());
+
+  // They're found nonetheless.
+  EXPECT_TRUE(symbol_map_.FindSymbol(ToPtr(0x1005)) != NULL);
+
+  // Looking them up published them.
+  EXPECT_EQ(0u, symbol_map_.pending_updates());
+  EXPECT_EQ(SymbolMap::kPublishBatchSize - 1, symbol_map_.snapshot_size());
+
+  // A full batch is published as it's made.
+  for (size_t i = 0; i < SymbolMap::kPublishBatchSize; ++i)
+    symbol_map_.AddSymbol(ToPtr(0x10000 + i * 0x100), 0x10, "bar");
+  EXPECT_EQ(0u, symbol_map_.pending_updates());
+  EXPECT_EQ(2 * SymbolMap::kPublishBatchSize - 1,
+            symbol_map_.snapshot_size());
+
+  // Publishing with nothing pending changes nothing.
+  symbol_map_.Publish();
+  EXPECT_EQ(2 * SymbolMap::kPublishBatchSize - 1,
+            symbol_map_.snapshot_size());
+}
+
+TEST_F(SymbolMapTest, FindSymbolInStaleSnapshot) {
+  symbol_map_.AddSymbol(ToPtr(0x1000), 0x20, "foo");
+  symbol_map_.Publish();
+  scoped_refptr<SymbolMap::Symbol> foo = symbol_map_.FindSymbol(ToPtr(0x1010));
+  ASSERT_TRUE(foo != NULL);
+
+  // The snapshot still has "foo" at its old address after it moves, and
+  // misses the symbol added since.
+  symbol_map_.MoveSymbol(ToPtr(0x1000), ToPtr(0x3000));
+  symbol_map_.AddSymbol(ToPtr(0x2000), 0x20, "bar");
+  EXPECT_EQ(2u, symbol_map_.pending_updates());
+  EXPECT_EQ(1u, symbol_map_.snapshot_size());
+
+  EXPECT_TRUE(symbol_map_.FindSymbol(ToPtr(0x1010)) == NULL);
+  EXPECT_EQ(foo, symbol_map_.FindSymbol(ToPtr(0x3010)));
+  scoped_refptr<SymbolMap::Symbol> bar = symbol_map_.FindSymbol(ToPtr(0x2010));
+  ASSERT_TRUE(bar != NULL);
+  EXPECT_EQ("bar", bar->name());
+
+  // Symbols added over a published symbol retire it.
+  symbol_map_.Publish();
+  symbol_map_.AddSymbol(ToPtr(0x2010), 0x20, "baz");
+  EXPECT_TRUE(bar->invalid());
+  scoped_refptr<SymbolMap::Symbol> baz = symbol_map_.FindSymbol(ToPtr(0x2018));
+  ASSERT_TRUE(baz != NULL);
+  EXPECT_EQ("baz", baz->name());
+  EXPECT_TRUE(symbol_map_.FindSymbol(ToPtr(0x2008)) == NULL);
+}
+
+TEST_F(SymbolMapTest, ConcurrentLookups) {
+  for (size_t i = 0; i < kNumSymbols; ++i) {
+    symbol_map_.AddSymbol(ToPtr(kRegions[0] + i * kSymbolSpacing),
+                          kSymbolLength, base::SizeTToString(i));
+  }
+
+  std::vector<std::unique_ptr<SymbolLookupThread>> lookups;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    lookups.push_back(std::unique_ptr<SymbolLookupThread>(
+        new SymbolLookupThread(&symbol_map_)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(lookups.back().get(),
+                                       "SymbolLookupThread")));
+    threads.back()->Start();
+  }
+
+  // Move the symbols back and forth while they're looked up.
+  for (size_t round = 0; round < 100; ++round) {
+    intptr_t from = kRegions[round % 2];
+    intptr_t to = kRegions[(round + 1) % 2];
+    for (size_t i = 0; i < kNumSymbols; ++i) {
+      symbol_map_.MoveSymbol(ToPtr(from + i * kSymbolSpacing),
+                             ToPtr(to + i * kSymbolSpacing));
+    }
+  }
+
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->Join();
+    EXPECT_EQ(0u, lookups[i]->mismatches());
+  }
+
+  // The symbols are back where they started.
+  symbol_map_.Publish();
+  for (size_t i = 0; i < kNumSymbols; ++i) {
+    scoped_refptr<SymbolMap::Symbol> symbol = symbol_map_.FindSymbol(
+        ToPtr(kRegions[0] + i * kSymbolSpacing));
+    ASSERT_TRUE(symbol != NULL);
+    EXPECT_EQ(base::SizeTToString(i), symbol->name());
+  }
+}
+
 }  // namespace profiler
 }  // namespace agent
@@ -14,10 +14,13 @@
 
 #include "syzygy/ar/ar_reader.h"
 
+#include <algorithm>
 #include <set>
 
+#include "base/atomicops.h"
 #include "base/logging.h"
 #include "base/strings/string_number_conversions.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/common/align.h"
 
 namespace ar {
@@ -93,16 +96,6 @@ bool ParseArFileHeader(const ArFileHeader& header,
   return true;
 }
 
-template<typename Object>
-bool ReadObject(FILE* file, Object* object) {
-  DCHECK_NE(reinterpret_cast<FILE*>(NULL), file);
-  DCHECK_NE(reinterpret_cast<Object*>(NULL), object);
-  if (::fread(object, sizeof(Object), 1, file) != 1) {
-    LOG(ERROR) << "Failed to read from archive.";
-    return false;
-  }
-  return true;
-}
 
 bool ParseSecondarySymbolTable(size_t file_size,
                                const uint8_t* data,
@@ -200,6 +193,46 @@ bool ParseSecondarySymbolTable(size_t file_size,
   return true;
 }
 
+// The work shared by the threads visiting the files of an archive. Each run
+// visits the next file that no thread has claimed yet, until one of them
+// fails.
+class ForEachFileWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  ForEachFileWork(const ArReader& reader,
+                  const ArReader::FileViewCallback& callback)
+      : reader_(reader), callback_(callback), next_index_(0), failed_(0) {
+  }
+
+  // @returns true if any file failed to be visited.
+  bool failed() const { return base::subtle::Acquire_Load(&failed_) != 0; }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, reader_.offsets().size());
+    if (failed())
+      return;
+
+    ParsedArFileHeader header;
+    const uint8_t* data = NULL;
+    if (!reader_.ExtractView(index, &header, &data) ||
+        !callback_.Run(index, header, data)) {
+      base::subtle::Release_Store(&failed_, 1);
+    }
+  }
+  // @}
+
+ private:
+  const ArReader& reader_;
+  const ArReader::FileViewCallback& callback_;
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(ForEachFileWork);
+};
+
 }  // namespace
 
 ArReader::ArReader()
@@ -210,28 +243,26 @@ bool ArReader::Init(const base::FilePath& ar_path) {
   DCHECK(path_.empty());
 
   path_ = ar_path;
-  file_.reset(base::OpenFile(path_, "rb"));
-  if (file_.get() == NULL) {
-    LOG(ERROR) << "Failed to open file for reading: " << path_.value();
-    return false;
-  }
-
-  if (!base::GetFileSize(path_, reinterpret_cast<int64_t*>(&length_))) {
-    LOG(ERROR) << "Unable to get the archive file size.";
+  if (!file_.Initialize(path_)) {
+    LOG(ERROR) << "Failed to map file for reading: " << path_.value();
     return false;
   }
+  length_ = file_.length();
 
   // Parse the global header.
-  ArGlobalHeader global_header = {};
-  if (!ReadObject(file_.get(), &global_header))
+  if (length_ < sizeof(ArGlobalHeader)) {
+    LOG(ERROR) << "Archive is too small to contain a global header.";
     return false;
-  if (::memcmp(global_header.magic,
+  }
+  const ArGlobalHeader* global_header =
+      reinterpret_cast<const ArGlobalHeader*>(file_.data());
+  if (::memcmp(global_header->magic,
                kArGlobalMagic,
                sizeof(kArGlobalMagic)) != 0) {
     LOG(ERROR) << "Invalid archive file global header.";
     return false;
   }
-  offset_ += sizeof(global_header);
+  offset_ += sizeof(*global_header);
 
   // Read (and ignore) the primary symbol table. This needs to be present but
   // it contains data that is also to be found in the secondary symbol table,
@@ -319,16 +350,7 @@ bool ArReader::SeekIndex(size_t index) {
   if (index >= offsets_.size())
     return false;
 
-  size_t offset = offsets_[index];
-  if (offset_ == offset)
-    return true;
-
-  if (::fseek(file_.get(), offset, SEEK_SET) != 0) {
-    LOG(ERROR) << "Failed to seek to archive file " << index
-               << " at offset " << offset << ".";
-    return false;
-  }
-  offset_ = offset;
+  offset_ = offsets_[index];
   index_ = index;
 
   return true;
@@ -356,13 +378,7 @@ bool ArReader::ExtractNext(ParsedArFileHeader* header,
   }
 
   // Seek to the beginning of the next archive file if we're not already there.
-  if (offset_ != offsets_[index_]) {
-    if (::fseek(file_.get(), offsets_[index_], SEEK_SET) != 0) {
-      LOG(ERROR) << "Failed to seek to file " << index_ << ".";
-      return false;
-    }
-    offset_ = offsets_[index_];
-  }
+  offset_ = offsets_[index_];
   DCHECK_LT(offset_, length_);
 
   if (!ReadNextFile(header, data))
@@ -387,10 +403,6 @@ bool ArReader::Extract(size_t index,
     return false;
 
   // Seek to the file in question.
-  if (::fseek(file_.get(), offsets_[index], SEEK_SET) != 0) {
-    LOG(ERROR) << "Failed to seek to file " << index << ".";
-    return false;
-  }
   offset_ = offsets_[index];
   index_ = index;
 
@@ -400,48 +412,109 @@ bool ArReader::Extract(size_t index,
   return true;
 }
 
-bool ArReader::ReadNextFile(ParsedArFileHeader* header,
-                            DataBuffer* data) {
+bool ArReader::ExtractView(size_t index,
+                           ParsedArFileHeader* header,
+                           const uint8_t** data) const {
   DCHECK_NE(reinterpret_cast<ParsedArFileHeader*>(NULL), header);
+  DCHECK_NE(reinterpret_cast<const uint8_t**>(NULL), data);
 
-  // Read and parse the file header.
-  ArFileHeader raw_header = {};
-  if (!ReadObject(file_.get(), &raw_header))
+  if (index >= offsets_.size())
     return false;
-  if (!ParseArFileHeader(raw_header, header))
+
+  uint64_t next_offset = 0;
+  if (!ParseFile(offsets_[index], header, data, &next_offset))
     return false;
-  offset_ += sizeof(raw_header);
 
-  uint64_t aligned_size = common::AlignUp64(header->size, kArFileAlignment);
-  uint64_t seek_size = aligned_size;
+  // Store the actual filename in the header.
+  std::string filename;
+  if (!TranslateFilename(header->name, &filename))
+    return false;
+  header->name = filename;
 
-  // Read the actual file contents if necessary.
-  if (data != NULL) {
-    seek_size = aligned_size - header->size;
-    data->resize(header->size);
-    if (::fread(data->data(), 1, header->size, file_.get()) !=
-            header->size) {
-      LOG(ERROR) << "Failed to read file \"" << header->name
-                 << "\" at offset " << offset_ << " of archive \""
-                 << path_.value() << "\".";
-      return false;
+  return true;
+}
+
+bool ArReader::ForEachFile(const FileViewCallback& callback,
+                           size_t num_threads) const {
+  DCHECK(!callback.is_null());
+  DCHECK_LT(0U, num_threads);
+
+  if (num_threads == 1 || offsets_.size() <= 1) {
+    for (size_t i = 0; i < offsets_.size(); ++i) {
+      ParsedArFileHeader header;
+      const uint8_t* data = NULL;
+      if (!ExtractView(i, &header, &data))
+        return false;
+      if (!callback.Run(i, header, data))
+        return false;
     }
-    offset_ += header->size;
+    return true;
   }
 
-  // Seek to the beginning of the next file.
-  if (seek_size > 0 && ::fseek(file_.get(), seek_size, SEEK_CUR) != 0) {
-    LOG(ERROR) << "Failed to seek to next file at offset " << offset_
+  ForEachFileWork work(*this, callback);
+  base::DelegateSimpleThreadPool pool(
+      "ArReader", static_cast<int>(std::min(num_threads, offsets_.size())));
+  pool.Start();
+  pool.AddWork(&work, static_cast<int>(offsets_.size()));
+  pool.JoinAll();
+
+  return !work.failed();
+}
+
+bool ArReader::ParseFile(uint64_t offset,
+                         ParsedArFileHeader* header,
+                         const uint8_t** data,
+                         uint64_t* next_offset) const {
+  DCHECK_NE(reinterpret_cast<ParsedArFileHeader*>(NULL), header);
+  DCHECK_NE(reinterpret_cast<const uint8_t**>(NULL), data);
+  DCHECK_NE(reinterpret_cast<uint64_t*>(NULL), next_offset);
+
+  // Parse the file header.
+  if (offset > length_ || length_ - offset < sizeof(ArFileHeader)) {
+    LOG(ERROR) << "Failed to read file header at offset " << offset
                << " of archive \"" << path_.value() << "\".";
     return false;
   }
-  offset_ += seek_size;
+  const ArFileHeader* raw_header =
+      reinterpret_cast<const ArFileHeader*>(file_.data() + offset);
+  if (!ParseArFileHeader(*raw_header, header))
+    return false;
+  offset += sizeof(*raw_header);
+
+  if (length_ - offset < header->size) {
+    LOG(ERROR) << "Failed to read file \"" << header->name
+               << "\" at offset " << offset << " of archive \""
+               << path_.value() << "\".";
+    return false;
+  }
+
+  *data = file_.data() + offset;
+  *next_offset = offset + common::AlignUp64(header->size, kArFileAlignment);
+
+  return true;
+}
+
+bool ArReader::ReadNextFile(ParsedArFileHeader* header,
+                            DataBuffer* data) {
+  DCHECK_NE(reinterpret_cast<ParsedArFileHeader*>(NULL), header);
+
+  const uint8_t* contents = NULL;
+  uint64_t next_offset = 0;
+  if (!ParseFile(offset_, header, &contents, &next_offset))
+    return false;
+
+  // Copy the actual file contents if necessary.
+  if (data != NULL)
+    data->assign(contents, contents + header->size);
+
+  // Move to the beginning of the next file.
+  offset_ = next_offset;
 
   return true;
 }
 
 bool ArReader::TranslateFilename(const std::string& internal_name,
-                                 std::string* full_name) {
+                                 std::string* full_name) const {
   DCHECK_NE(reinterpret_cast<std::string*>(NULL), full_name);
 
   if (internal_name.empty()) {
@@ -472,7 +545,7 @@ bool ArReader::TranslateFilename(const std::string& internal_name,
     return false;
   }
 
-  const char* data = reinterpret_cast<char*>(filenames_.data());
+  const char* data = reinterpret_cast<const char*>(filenames_.data());
   size_t filename_length = ::strnlen(data + filename_offset,
                                      filenames_.size() - filename_offset);
   *full_name = std::string(data + filename_offset, filename_length);
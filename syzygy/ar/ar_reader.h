@@ -82,14 +82,20 @@
 #include <map>
 #include <vector>
 
+#include "base/callback.h"
 #include "base/files/file_path.h"
-#include "base/files/file_util.h"
+#include "base/files/memory_mapped_file.h"
 #include "syzygy/ar/ar_common.h"
 
 namespace ar {
 
 // Class for extracting files from archive files. This currently does not
 // expose the parsed symbol information in any meaningful way.
+//
+// The archive is memory mapped for the lifetime of the reader. Files can be
+// extracted to buffers via the cursor-based ExtractNext and Extract, or viewed
+// in place via ExtractView and ForEachFile. The latter don't touch the cursor
+// and may be used concurrently.
 class ArReader {
  public:
   // Stores the offsets of each file object, by their index.
@@ -102,6 +108,17 @@ class ArReader {
   // Stores filenames indexed by the file number.
   typedef std::vector<std::string> FileNameVector;
 
+  // The type of callback invoked by ForEachFile. If this returns false then
+  // the iteration terminates with an error.
+  // |index| The index of the file in the archive.
+  // |header| The header of the file, with its full name.
+  // |data| The contents of the file, of header.size bytes. This points into
+  //     the mapped archive and is valid for the lifetime of the reader.
+  typedef base::Callback<bool(size_t /* index */,
+                              const ParsedArFileHeader& /* header */,
+                              const uint8_t* /* data */)>
+      FileViewCallback;
+
   ArReader();
 
   // Opens the provided file, validating that it is indeed an archive file,
@@ -165,7 +182,40 @@ class ArReader {
                ParsedArFileHeader* header,
                DataBuffer* data);
 
+  // Gets a view of the specified file, without copying its contents. This
+  // doesn't move the cursor and is safe to call concurrently.
+  // @param index The index of the file to be viewed.
+  // @param header The header to be populated.
+  // @param data Receives a pointer to the header.size bytes of content of the
+  //     file. This is valid for the lifetime of the reader.
+  // @returns true on success, false otherwise.
+  bool ExtractView(size_t index,
+                   ParsedArFileHeader* header,
+                   const uint8_t** data) const;
+
+  // Invokes @p callback with a view of every file in the archive. This
+  // doesn't move the cursor.
+  // @param callback The callback to be invoked. If @p num_threads is more
+  //     than one this must be thread safe, as it is then invoked concurrently
+  //     for different files, in no particular order.
+  // @param num_threads The number of threads to visit the files on.
+  // @returns true if every invocation of the callback succeeded, false
+  //     otherwise.
+  bool ForEachFile(const FileViewCallback& callback, size_t num_threads) const;
+
  protected:
+  // Parses the file at the given offset in the archive. Does not translate
+  // the internal name to an external filename.
+  // @param offset The offset of the file header in the archive.
+  // @param header The header to be populated.
+  // @param data Receives a pointer to the contents of the file.
+  // @param next_offset Receives the offset of the following file.
+  // @returns true on success, false otherwise.
+  bool ParseFile(uint64_t offset,
+                 ParsedArFileHeader* header,
+                 const uint8_t** data,
+                 uint64_t* next_offset) const;
+
   // Reads the next file from the archive, advancing the cursor. Returns true
   // on success, false otherwise. Does not translate the internal name to an
   // external filename. Doesn't update 'index_'.
@@ -173,11 +223,11 @@ class ArReader {
 
   // Translates an archive internal filename to the full extended filename.
   bool TranslateFilename(const std::string& internal_name,
-                         std::string* full_name);
+                         std::string* full_name) const;
 
-  // The file that is being read.
+  // The file that is being read, and its mapping.
   base::FilePath path_;
-  base::ScopedFILE file_;
+  base::MemoryMappedFile file_;
 
   // Data regarding the archive.
   uint64_t length_;
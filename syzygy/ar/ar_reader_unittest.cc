@@ -14,6 +14,8 @@
 
 #include "syzygy/ar/ar_reader.h"
 
+#include "base/bind.h"
+#include "base/synchronization/lock.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/ar/unittest_util.h"
@@ -40,6 +42,37 @@ class ArReaderTest : public testing::Test {
   base::FilePath lib_path_;
 };
 
+// Records the files visited by ArReader::ForEachFile.
+class FileVisitor {
+ public:
+  typedef std::map<size_t, std::pair<std::string, DataBuffer>> FileMap;
+
+  bool Visit(size_t index,
+             const ParsedArFileHeader& header,
+             const uint8_t* data) {
+    base::AutoLock auto_lock(lock_);
+    std::pair<std::string, DataBuffer>& file = files_[index];
+    file.first = header.name;
+    file.second.assign(data, data + header.size);
+    return true;
+  }
+
+  bool FailOnIndex(size_t failing_index,
+                   size_t index,
+                   const ParsedArFileHeader& header,
+                   const uint8_t* data) {
+    if (index == failing_index)
+      return false;
+    return Visit(index, header, data);
+  }
+
+  const FileMap& files() const { return files_; }
+
+ private:
+  base::Lock lock_;
+  FileMap files_;
+};
+
 }  // namespace
 
 TEST_F(ArReaderTest, InitAndBuildFileIndex) {
@@ -135,6 +168,68 @@ TEST_F(ArReaderTest, InitAndBuildFileIndex) {
   EXPECT_TRUE(reader.HasNext());
 }
 
+TEST_F(ArReaderTest, ExtractViewMatchesExtract) {
+  ArReader reader;
+  ASSERT_TRUE(reader.Init(lib_path_));
+
+  for (size_t i = 0; i < reader.offsets().size(); ++i) {
+    ParsedArFileHeader header;
+    DataBuffer data;
+    EXPECT_TRUE(reader.Extract(i, &header, &data));
+
+    ParsedArFileHeader view_header;
+    const uint8_t* view = NULL;
+    EXPECT_TRUE(reader.ExtractView(i, &view_header, &view));
+    EXPECT_EQ(header.name, view_header.name);
+    ASSERT_EQ(header.size, view_header.size);
+    EXPECT_EQ(0, ::memcmp(data.data(), view, data.size()));
+  }
+
+  ParsedArFileHeader header;
+  const uint8_t* view = NULL;
+  EXPECT_FALSE(reader.ExtractView(reader.offsets().size(), &header, &view));
+}
+
+TEST_F(ArReaderTest, ForEachFile) {
+  ArReader reader;
+  ASSERT_TRUE(reader.Init(lib_path_));
+
+  FileVisitor serial;
+  EXPECT_TRUE(reader.ForEachFile(
+      base::Bind(&FileVisitor::Visit, base::Unretained(&serial)), 1));
+  ASSERT_EQ(reader.offsets().size(), serial.files().size());
+
+  FileVisitor parallel;
+  EXPECT_TRUE(reader.ForEachFile(
+      base::Bind(&FileVisitor::Visit, base::Unretained(&parallel)), 4));
+  EXPECT_EQ(serial.files(), parallel.files());
+
+  // The cursor is left untouched.
+  EXPECT_TRUE(reader.HasNext());
+  ParsedArFileHeader header;
+  DataBuffer data;
+  EXPECT_TRUE(reader.ExtractNext(&header, &data));
+  EXPECT_EQ(serial.files().at(0).first, header.name);
+  EXPECT_EQ(serial.files().at(0).second, data);
+}
+
+TEST_F(ArReaderTest, ForEachFileFails) {
+  ArReader reader;
+  ASSERT_TRUE(reader.Init(lib_path_));
+
+  FileVisitor serial;
+  EXPECT_FALSE(reader.ForEachFile(
+      base::Bind(&FileVisitor::FailOnIndex, base::Unretained(&serial), 3),
+      1));
+  EXPECT_EQ(3u, serial.files().size());
+
+  FileVisitor parallel;
+  EXPECT_FALSE(reader.ForEachFile(
+      base::Bind(&FileVisitor::FailOnIndex, base::Unretained(&parallel), 3),
+      4));
+  EXPECT_EQ(0u, parallel.files().count(3));
+}
+
 TEST_F(ArReaderTest, NoFilenameTable) {
   base::FilePath lib = testing::GetSrcRelativePath(
       testing::kWeakSymbolArchiveFile);
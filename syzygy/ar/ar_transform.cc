@@ -14,11 +14,15 @@
 
 #include "syzygy/ar/ar_transform.h"
 
+#include <algorithm>
+
+#include "base/atomicops.h"
 #include "base/bind.h"
 #include "base/logging.h"
 #include "base/files/file_util.h"
 #include "base/memory/scoped_vector.h"
 #include "base/strings/stringprintf.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/ar/ar_reader.h"
 #include "syzygy/ar/ar_writer.h"
 
@@ -26,6 +30,10 @@ namespace ar {
 
 namespace {
 
+// The number of files handed to each thread per batch. Only one batch of files
+// is held in memory at a time.
+const size_t kFilesPerThread = 4;
+
 // Helper struct to delete a file when this object goes out of scope.
 struct FileDeleter {
   explicit FileDeleter(const base::FilePath& path) : path_(path) {
@@ -39,6 +47,81 @@ struct FileDeleter {
   const base::FilePath& path_;
 };
 
+// A file of the archive, along with the outcome of its transform.
+struct ArchiveFile {
+  ArchiveFile() : remove(false), succeeded(false) {
+  }
+
+  ParsedArFileHeader header;
+  DataBuffer contents;
+  bool remove;
+  bool succeeded;
+};
+
+// Transforms one file of the archive.
+// @param callback The transform callback.
+// @param index The index of the file in the archive.
+// @param count The number of files in the archive.
+// @param file The file to transform.
+// @returns true on success, false otherwise.
+bool TransformFile(const ArTransform::TransformFileCallback& callback,
+                   size_t index,
+                   size_t count,
+                   ArchiveFile* file) {
+  DCHECK(file != NULL);
+
+  LOG(INFO) << "Processing file " << (index + 1) << " of " << count << ": "
+            << file->header.name;
+  file->succeeded = callback.Run(&file->header, &file->contents,
+                                 &file->remove);
+  return file->succeeded;
+}
+
+// The work shared by the threads transforming a batch of files of an archive.
+// Each run transforms the next file that no thread has claimed yet, until one
+// of them fails.
+class TransformWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param callback The transform callback.
+  // @param first_index The index in the archive of the first file of the
+  //     batch.
+  // @param count The number of files in the archive.
+  // @param files The batch of files to transform.
+  TransformWork(const ArTransform::TransformFileCallback& callback,
+                size_t first_index,
+                size_t count,
+                ScopedVector<ArchiveFile>* files)
+      : callback_(callback), first_index_(first_index), count_(count),
+        files_(files), next_index_(0), failed_(0) {
+    DCHECK(files != NULL);
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, files_->size());
+    if (base::subtle::Acquire_Load(&failed_))
+      return;
+    if (!TransformFile(callback_, first_index_ + index, count_,
+                       (*files_)[index])) {
+      base::subtle::Release_Store(&failed_, 1);
+    }
+  }
+  // @}
+
+ private:
+  const ArTransform::TransformFileCallback& callback_;
+  size_t first_index_;
+  size_t count_;
+  ScopedVector<ArchiveFile>* files_;
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(TransformWork);
+};
+
 }  // namespace
 
 bool ArTransform::Transform() {
@@ -51,40 +134,63 @@ bool ArTransform::Transform() {
     return false;
   LOG(INFO) << "Read " << reader.symbols().size() << " symbols.";
 
-  // This collection of buffers must outlive the ArWriter below.
-  ScopedVector<DataBuffer> buffers;
-
-  // Iterate over the files in the archive.
-  ArWriter writer;
-  for (size_t i = 0; i < reader.offsets().size(); ++i) {
-    // Extract the next file.
-    ParsedArFileHeader header;
-    std::unique_ptr<DataBuffer> buffer(new DataBuffer());
-    if (!reader.ExtractNext(&header, buffer.get()))
-      return false;
-
-    LOG(INFO) << "Processing file " << (i + 1) << " of "
-              << reader.offsets().size() << ": " << header.name;
-
-    // Apply the transform to this file.
-    bool remove = false;
-    if (!callback_.Run(&header, buffer.get(), &remove))
-      return false;
-
-    if (remove)
-      continue;
-
-    // Add the transformed file to the output archive.
-    if (!writer.AddFile(header.name, header.timestamp, header.mode,
-                        buffer.get())) {
-      return false;
+  // The transformed files are streamed to the output archive as each batch
+  // completes, in their original order.
+  ArStreamWriter writer;
+  if (!writer.Open(output_archive_))
+    return false;
+
+  size_t count = reader.offsets().size();
+  size_t batch_size = num_threads_ * kFilesPerThread;
+  for (size_t first = 0; first < count; first += batch_size) {
+    size_t batch_count = std::min(batch_size, count - first);
+
+    // Copy the files of the batch out of the mapped archive, as the transform
+    // modifies them in place.
+    ScopedVector<ArchiveFile> files;
+    for (size_t i = 0; i < batch_count; ++i) {
+      std::unique_ptr<ArchiveFile> file(new ArchiveFile());
+      const uint8_t* data = NULL;
+      if (!reader.ExtractView(first + i, &file->header, &data))
+        return false;
+      file->contents.assign(data, data + file->header.size);
+      files.push_back(file.release());
     }
 
-    // Save the buffer so we keep it around until the writer has finished.
-    buffers.push_back(buffer.release());
+    // Apply the transform to each file.
+    if (num_threads_ == 1 || files.size() <= 1) {
+      for (size_t i = 0; i < files.size(); ++i) {
+        if (!TransformFile(callback_, first + i, count, files[i]))
+          return false;
+      }
+    } else {
+      TransformWork work(callback_, first, count, &files);
+      base::DelegateSimpleThreadPool pool(
+          "ArTransform",
+          static_cast<int>(std::min(num_threads_, files.size())));
+      pool.Start();
+      pool.AddWork(&work, static_cast<int>(files.size()));
+      pool.JoinAll();
+      for (const ArchiveFile* file : files) {
+        if (!file->succeeded)
+          return false;
+      }
+    }
+
+    // Add the transformed files to the output archive.
+    for (const ArchiveFile* file : files) {
+      if (file->remove)
+        continue;
+
+      if (!writer.AddFile(file->header.name, file->header.timestamp,
+                          file->header.mode, file->contents.data(),
+                          file->contents.size())) {
+        return false;
+      }
+    }
   }
 
-  if (!writer.Write(output_archive_))
+  if (!writer.Close())
     return false;
   LOG(INFO) << "Wrote " << writer.symbols().size() << " symbols.";
 
@@ -109,20 +215,25 @@ OnDiskArTransformAdapter::~OnDiskArTransformAdapter() {
 bool OnDiskArTransformAdapter::Transform(ParsedArFileHeader* header,
                                          DataBuffer* contents,
                                          bool* remove) {
-  if (temp_dir_.empty()) {
-    if (!base::CreateNewTempDirectory(L"OnDiskArTransformAdapter",
-                                           &temp_dir_)) {
-      LOG(ERROR) << "Unable to create temporary directory.";
-      return false;
+  base::FilePath input_path;
+  base::FilePath output_path;
+  {
+    base::AutoLock auto_lock(lock_);
+    if (temp_dir_.empty()) {
+      if (!base::CreateNewTempDirectory(L"OnDiskArTransformAdapter",
+                                             &temp_dir_)) {
+        LOG(ERROR) << "Unable to create temporary directory.";
+        return false;
+      }
     }
-  }
 
-  // Create input and output file names.
-  base::FilePath input_path = temp_dir_.Append(
-      base::StringPrintf(L"input-%04d.obj", index_));
-  base::FilePath output_path = temp_dir_.Append(
-      base::StringPrintf(L"output-%04d.obj", index_));
-  ++index_;
+    // Create input and output file names.
+    input_path = temp_dir_.Append(
+        base::StringPrintf(L"input-%04d.obj", index_));
+    output_path = temp_dir_.Append(
+        base::StringPrintf(L"output-%04d.obj", index_));
+    ++index_;
+  }
 
   // Set up deleters for these files.
   FileDeleter input_deleter(input_path);
@@ -22,6 +22,7 @@
 #include "base/callback.h"
 #include "base/logging.h"
 #include "base/files/file_path.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/ar/ar_common.h"
 
 namespace ar {
@@ -44,9 +45,11 @@ class ArTransform {
       TransformFileCallback;
 
   // Constructor.
-  ArTransform() { }
+  ArTransform() : num_threads_(1) { }
 
   // Applies the transform. The transform must already have been configured.
+  // The files are written to the output archive in their original order,
+  // regardless of the number of threads.
   // @returns true on success, false otherwise.
   bool Transform();
 
@@ -72,6 +75,15 @@ class ArTransform {
     DCHECK(!callback.is_null());
     callback_ = callback;
   }
+
+  // Sets the number of threads the files are transformed on. If this is more
+  // than one the callback must be thread safe, as it is then invoked
+  // concurrently for different files. Defaults to 1.
+  // @param num_threads The number of threads.
+  void set_num_threads(size_t num_threads) {
+    DCHECK_LT(0U, num_threads);
+    num_threads_ = num_threads;
+  }
   // @}
 
   // @name Accessors.
@@ -84,18 +96,23 @@ class ArTransform {
 
   // @returns the callback.
   TransformFileCallback callback() const { return callback_; }
+
+  // @returns the number of threads the files are transformed on.
+  size_t num_threads() const { return num_threads_; }
   // @}
 
  private:
   base::FilePath input_archive_;
   base::FilePath output_archive_;
   TransformFileCallback callback_;
+  size_t num_threads_;
 
   DISALLOW_COPY_AND_ASSIGN(ArTransform);
 };
 
 // A callback adapter that allows transforms to modify the files
-// on disk rather than in memory. This is not thread safe.
+// on disk rather than in memory. The outer callback is thread safe as long as
+// the inner one is.
 class OnDiskArTransformAdapter {
  public:
   typedef ArTransform::TransformFileCallback TransformFileCallback;
@@ -143,7 +160,10 @@ class OnDiskArTransformAdapter {
   TransformFileOnDiskCallback inner_callback_;
   TransformFileCallback outer_callback_;
 
-  // Temporary directory where files are produced.
+  // Protects temp_dir_ and index_.
+  base::Lock lock_;
+
+  // Temporary directory where files are produced. Under lock_.
   base::FilePath temp_dir_;
   size_t index_;
 };
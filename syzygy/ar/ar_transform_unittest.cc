@@ -137,6 +137,72 @@ TEST_F(ArTransformTest, TransformIdentityInMemory) {
   EXPECT_EQ(testing::kArchiveFileCount, reader.offsets().size());
 }
 
+TEST_F(ArTransformTest, TransformIdentityInMemoryInParallel) {
+  ArTransform tx;
+  tx.set_input_archive(input_archive_);
+  tx.set_output_archive(output_archive_);
+  tx.set_callback(in_memory_callback_);
+  tx.set_num_threads(4);
+  EXPECT_EQ(4u, tx.num_threads());
+
+  EXPECT_CALL(*this, InMemoryCallback(_, _, _))
+      .Times(testing::kArchiveFileCount).WillRepeatedly(Return(true));
+
+  EXPECT_TRUE(tx.Transform());
+  EXPECT_TRUE(base::PathExists(output_archive_));
+
+  // The files are written in their original order.
+  ArReader input_reader;
+  ArReader output_reader;
+  ASSERT_TRUE(input_reader.Init(input_archive_));
+  ASSERT_TRUE(output_reader.Init(output_archive_));
+  ASSERT_EQ(input_reader.offsets().size(), output_reader.offsets().size());
+  for (size_t i = 0; i < input_reader.offsets().size(); ++i) {
+    ParsedArFileHeader input_header;
+    ParsedArFileHeader output_header;
+    DataBuffer input_contents;
+    DataBuffer output_contents;
+    ASSERT_TRUE(input_reader.ExtractNext(&input_header, &input_contents));
+    ASSERT_TRUE(output_reader.ExtractNext(&output_header, &output_contents));
+    EXPECT_EQ(input_header.name, output_header.name);
+    EXPECT_EQ(input_contents, output_contents);
+  }
+}
+
+TEST_F(ArTransformTest, TransformFailsInMemoryCallbackFailsInParallel) {
+  ArTransform tx;
+  tx.set_input_archive(input_archive_);
+  tx.set_output_archive(output_archive_);
+  tx.set_callback(in_memory_callback_);
+  tx.set_num_threads(4);
+
+  // The files already claimed by other threads are still transformed.
+  EXPECT_CALL(*this, InMemoryCallback(_, _, _))
+      .Times(testing::AtLeast(1)).WillRepeatedly(Return(false));
+
+  EXPECT_FALSE(tx.Transform());
+  EXPECT_FALSE(base::PathExists(output_archive_));
+}
+
+TEST_F(ArTransformTest, TransformIdentityOnDiskInParallel) {
+  ArTransform tx;
+  tx.set_input_archive(input_archive_);
+  tx.set_output_archive(output_archive_);
+  tx.set_callback(on_disk_adapter_.outer_callback());
+  tx.set_num_threads(4);
+
+  EXPECT_CALL(*this, OnDiskCallback(_, _, _, _))
+      .Times(testing::kArchiveFileCount)
+      .WillRepeatedly(Invoke(this, &ArTransformTest::OnDiskCallbackCopyFile));
+
+  EXPECT_TRUE(tx.Transform());
+  EXPECT_TRUE(base::PathExists(output_archive_));
+
+  ArReader reader;
+  EXPECT_TRUE(reader.Init(output_archive_));
+  EXPECT_EQ(testing::kArchiveFileCount, reader.offsets().size());
+}
+
 TEST_F(ArTransformTest, TransformFailsOnDiskCallbackFails) {
     ArTransform tx;
   tx.set_input_archive(input_archive_);
@@ -40,6 +40,9 @@ typedef ArWriter::FileVector FileVector;
 // Contains a list of file offsets at which each file starts in the archive.
 typedef std::vector<uint32_t> FileOffsets;
 
+// The size of the chunks in which spooled files are copied to the archive.
+const size_t kCopyBufferSize = 1024 * 1024;
+
 // Determines if a symbol should be added to the symbol table. The rules as to
 // what symbols should be exported has been derived by observation of inputs
 // and outputs to lib.exe, guided by available documentation.
@@ -149,14 +152,15 @@ bool UpdateSymbolTable(uint32_t file_index,
 // using those classes is a little overkill for our purposes.
 bool ExtractSymbolsCoff(uint32_t file_index,
                         const ParsedArFileHeader& header,
-                        const DataBuffer& file_contents,
+                        const uint8_t* contents,
+                        size_t size,
                         SymbolIndexMap* symbols,
                         SymbolIndexMap* weak_symbols) {
+  DCHECK_NE(reinterpret_cast<const uint8_t*>(NULL), contents);
   DCHECK_NE(reinterpret_cast<SymbolIndexMap*>(NULL), symbols);
   DCHECK_NE(reinterpret_cast<SymbolIndexMap*>(NULL), weak_symbols);
 
-  common::BinaryBufferReader reader(file_contents.data(),
-                                    file_contents.size());
+  common::BinaryBufferReader reader(contents, size);
   const IMAGE_FILE_HEADER* file_header = NULL;
   if (!reader.Read(&file_header))
     return false;
@@ -202,15 +206,14 @@ bool ExtractSymbolsCoff(uint32_t file_index,
       const char* s = NULL;
       size_t max_len = 0;
       if (symbol->N.Name.Short == 0) {
-        if (symbol->N.Name.Long >= file_contents.size()) {
+        if (symbol->N.Name.Long >= size) {
           LOG(ERROR) << "Invalid symbol name pointer in object file: "
                      << header.name;
           return false;
         }
         size_t offset = string_table_offset + symbol->N.Name.Long;
-        s = reinterpret_cast<const char*>(file_contents.data()) +
-            offset;
-        max_len = file_contents.size() - offset;
+        s = reinterpret_cast<const char*>(contents) + offset;
+        max_len = size - offset;
       } else {
         s = reinterpret_cast<const char*>(symbol->N.ShortName);
         max_len = sizeof(symbol->N.ShortName);
@@ -237,14 +240,15 @@ bool ExtractSymbolsCoff(uint32_t file_index,
 // |symbols|. Returns true on success, false otherwise.
 bool ExtractSymbolsImportDef(uint32_t file_index,
                              const ParsedArFileHeader& header,
-                             const DataBuffer& file_contents,
+                             const uint8_t* contents,
+                             size_t size,
                              SymbolIndexMap* symbols,
                              SymbolIndexMap* weak_symbols) {
+  DCHECK_NE(reinterpret_cast<const uint8_t*>(NULL), contents);
   DCHECK_NE(reinterpret_cast<SymbolIndexMap*>(NULL), symbols);
   DCHECK_NE(reinterpret_cast<SymbolIndexMap*>(NULL), weak_symbols);
 
-  common::BinaryBufferReader reader(file_contents.data(),
-                                    file_contents.size());
+  common::BinaryBufferReader reader(contents, size);
   const IMPORT_OBJECT_HEADER* import = NULL;
   if (!reader.Read(&import))
     return false;
@@ -275,12 +279,12 @@ bool ExtractSymbolsImportDef(uint32_t file_index,
 // type, then this does nothing.
 bool ExtractSymbols(uint32_t file_index,
                     const ParsedArFileHeader& header,
-                    const DataBuffer& file_contents,
+                    const uint8_t* contents,
+                    size_t size,
                     SymbolIndexMap* symbols,
                     SymbolIndexMap* weak_symbols) {
   core::FileType file_type = core::kUnknownFileType;
-  if (!core::GuessFileType(file_contents.data(), file_contents.size(),
-                           &file_type)) {
+  if (!core::GuessFileType(contents, size, &file_type)) {
     LOG(ERROR) << "Unable to determine file type: " << header.name;
     return false;
   }
@@ -288,7 +292,7 @@ bool ExtractSymbols(uint32_t file_index,
   switch (file_type) {
     case core::kCoffFileType:
     case core::kCoff64FileType: {
-      if (!ExtractSymbolsCoff(file_index, header, file_contents, symbols,
+      if (!ExtractSymbolsCoff(file_index, header, contents, size, symbols,
                               weak_symbols)) {
         return false;
       }
@@ -296,8 +300,8 @@ bool ExtractSymbols(uint32_t file_index,
     }
 
     case core::kImportDefinitionFileType: {
-      if (!ExtractSymbolsImportDef(file_index, header, file_contents, symbols,
-                                   weak_symbols)) {
+      if (!ExtractSymbolsImportDef(file_index, header, contents, size,
+                                   symbols, weak_symbols)) {
         return false;
       }
       break;
@@ -332,6 +336,44 @@ bool ExtractSymbols(uint32_t file_index,
   return true;
 }
 
+// Extracts the symbols of the given file and merges them into the symbol
+// tables. The symbols are first gathered in tables of their own, so that
+// |symbols| and |weak_symbols| are left untouched if the file can't be parsed.
+bool AddFileSymbols(uint32_t file_index,
+                    const ParsedArFileHeader& header,
+                    const uint8_t* contents,
+                    size_t size,
+                    SymbolIndexMap* symbols,
+                    SymbolIndexMap* weak_symbols) {
+  DCHECK_NE(reinterpret_cast<SymbolIndexMap*>(NULL), symbols);
+  DCHECK_NE(reinterpret_cast<SymbolIndexMap*>(NULL), weak_symbols);
+
+  SymbolIndexMap file_symbols;
+  SymbolIndexMap file_weak_symbols;
+  if (!ExtractSymbols(file_index, header, contents, size, &file_symbols,
+                      &file_weak_symbols)) {
+    return false;
+  }
+
+  size_t duplicate_symbols = 0;
+  SymbolIndexMap::const_iterator it = file_symbols.begin();
+  for (; it != file_symbols.end(); ++it) {
+    bool is_weak = file_weak_symbols.count(it->first) != 0;
+    if (UpdateSymbolTable(file_index, it->first, is_weak, symbols,
+                          weak_symbols)) {
+      ++duplicate_symbols;
+    }
+  }
+
+  if (duplicate_symbols) {
+    LOG(INFO) << "Ignored " << duplicate_symbols
+              << " symbols already defined by other files in the archive: "
+              << header.name;
+  }
+
+  return true;
+}
+
 // Fills in a raw ArFileHeader with the data from |parsed_header|.
 bool PopulateArFileHeader(const ParsedArFileHeader& parsed_header,
                           ArFileHeader* raw_header) {
@@ -375,9 +417,42 @@ bool PopulateArFileHeader(const ParsedArFileHeader& parsed_header,
   return true;
 }
 
+// Fills in a raw ArFileHeader for an object file. Names that don't fit in the
+// header are appended to the extended name table |names|, and referred to by
+// their offset in it.
+bool PopulateObjectFileHeader(const ParsedArFileHeader& parsed_header,
+                              DataBuffer* names,
+                              ArFileHeader* raw_header) {
+  DCHECK_NE(reinterpret_cast<DataBuffer*>(NULL), names);
+  DCHECK_NE(reinterpret_cast<ArFileHeader*>(NULL), raw_header);
+
+  // Grab a copy of the header because we are going to modify it.
+  ParsedArFileHeader header = parsed_header;
+
+  // Translate the filename.
+  if (header.name.size() >= sizeof(raw_header->name)) {
+    // Copy the extended filename to the name table, with a terminating
+    // null.
+    size_t offset = names->size();
+    names->resize(offset + header.name.size() + 1);
+    ::memcpy(names->data() + offset, header.name.data(),
+             header.name.size() + 1);
+
+    // Name the file with a reference to the name table.
+    header.name = base::StringPrintf("/%d", offset);
+  } else {
+    // Simply append a trailing '/' to the name.
+    header.name += "/";
+  }
+
+  // Fill in the raw file header.
+  return PopulateArFileHeader(header, raw_header);
+}
+
 // Writes the given file to an archive, prepended by its header.
 bool WriteFile(const ArFileHeader& header,
-               const DataBuffer& contents,
+               const uint8_t* contents,
+               size_t size,
                FILE* file) {
   DCHECK_NE(reinterpret_cast<FILE*>(NULL), file);
 
@@ -388,8 +463,7 @@ bool WriteFile(const ArFileHeader& header,
   }
 
   // Write the contents.
-  if (::fwrite(contents.data(), 1, contents.size(), file) !=
-               contents.size()) {
+  if (size != 0 && ::fwrite(contents, 1, size, file) != size) {
     LOG(ERROR) << "Failed to write file contents.";
     return false;
   }
@@ -438,7 +512,7 @@ bool WritePrimarySymbolTable(const base::Time& timestamp,
   ArFileHeader raw_header;
   if (!PopulateArFileHeader(header, &raw_header))
     return false;
-  if (!WriteFile(raw_header, buffer, file))
+  if (!WriteFile(raw_header, buffer.data(), buffer.size(), file))
     return false;
 
   return true;
@@ -475,7 +549,7 @@ bool WriteSecondarySymbolTable(const base::Time& timestamp,
   ArFileHeader raw_header;
   if (!PopulateArFileHeader(header, &raw_header))
     return false;
-  if (!WriteFile(raw_header, buffer, file))
+  if (!WriteFile(raw_header, buffer.data(), buffer.size(), file))
     return false;
 
   return true;
@@ -498,7 +572,7 @@ bool WriteNameTable(const base::Time& timestamp,
   if (!PopulateArFileHeader(header, &raw_header))
     return false;
 
-  if (!WriteFile(raw_header, names, file))
+  if (!WriteFile(raw_header, names.data(), names.size(), file))
     return false;
 
   return true;
@@ -519,6 +593,65 @@ uint32_t AlignAndGetPosition(FILE* file) {
   return aligned_pos;
 }
 
+// Writes the global header and the symbol and name tables that precede the
+// object files in an archive. The positions of the symbol tables are returned
+// in |symbols1_pos| and |symbols2_pos| so that they may later be rewritten.
+bool WriteArchiveHeaders(const base::Time& timestamp,
+                         const SymbolIndexMap& symbols,
+                         const FileOffsets& offsets,
+                         const DataBuffer& names,
+                         FILE* file,
+                         uint32_t* symbols1_pos,
+                         uint32_t* symbols2_pos) {
+  DCHECK_NE(reinterpret_cast<FILE*>(NULL), file);
+  DCHECK_NE(reinterpret_cast<uint32_t*>(NULL), symbols1_pos);
+  DCHECK_NE(reinterpret_cast<uint32_t*>(NULL), symbols2_pos);
+
+  if (::fwrite(kArGlobalMagic, sizeof(kArGlobalMagic), 1, file) != 1) {
+    LOG(ERROR) << "Failed to write global archive header.";
+    return false;
+  }
+
+  *symbols1_pos = AlignAndGetPosition(file);
+  if (!WritePrimarySymbolTable(timestamp, symbols, offsets, file))
+    return false;
+  *symbols2_pos = AlignAndGetPosition(file);
+  if (!WriteSecondarySymbolTable(timestamp, symbols, offsets, file))
+    return false;
+
+  AlignAndGetPosition(file);
+  if (!WriteNameTable(timestamp, names, file))
+    return false;
+
+  return true;
+}
+
+// Rewrites the symbol tables written by WriteArchiveHeaders, now that the
+// actual file offsets are known.
+bool RewriteSymbolTables(const base::Time& timestamp,
+                         const SymbolIndexMap& symbols,
+                         const FileOffsets& offsets,
+                         uint32_t symbols1_pos,
+                         uint32_t symbols2_pos,
+                         FILE* file) {
+  DCHECK_NE(reinterpret_cast<FILE*>(NULL), file);
+
+  if (::fseek(file, symbols1_pos, SEEK_SET) != 0) {
+    LOG(ERROR) << "Failed to seek to primary symbol stream.";
+    return false;
+  }
+  if (!WritePrimarySymbolTable(timestamp, symbols, offsets, file))
+    return false;
+  if (::fseek(file, symbols2_pos, SEEK_SET) != 0) {
+    LOG(ERROR) << "Failed to seek to secondary symbol stream.";
+    return false;
+  }
+  if (!WriteSecondarySymbolTable(timestamp, symbols, offsets, file))
+    return false;
+
+  return true;
+}
+
 }  // namespace
 
 ArWriter::ArWriter() {
@@ -550,18 +683,14 @@ bool ArWriter::AddFile(const base::StringPiece& filename,
   header.mode = mode;
   header.size = contents->size();
 
-  // Try to parse the symbols from the file. We keep a copy of the
-  // symbol tables so as not to corrupt them if the operation fails.
-  SymbolIndexMap symbols = symbols_;
-  SymbolIndexMap weak_symbols = weak_symbols_;
-  if (!ExtractSymbols(files_.size(), header, *contents, &symbols,
-                      &weak_symbols)) {
+  // Try to parse the symbols from the file. The symbol tables are left
+  // untouched if this fails.
+  if (!AddFileSymbols(files_.size(), header, contents->data(),
+                      contents->size(), &symbols_, &weak_symbols_)) {
     return false;
   }
 
   // If all goes well then commit the file to the archive.
-  std::swap(symbols_, symbols);
-  std::swap(weak_symbols_, weak_symbols);
   files_.push_back(std::make_pair(header, contents));
   return true;
 }
@@ -610,58 +739,28 @@ bool ArWriter::Write(const base::FilePath& path) {
   std::vector<ArFileHeader> raw_headers(files_.size());
   DataBuffer names;
   for (size_t i = 0; i < files_.size(); ++i) {
-    // Grab a copy of the header because we are going to modify it.
-    ParsedArFileHeader header = files_[i].first;
-    ArFileHeader& raw_header = raw_headers[i];
-
-    // Translate the filename.
-    if (header.name.size() >= sizeof(raw_header.name)) {
-      // Copy the extended filename to the name table, with a terminating
-      // null.
-      size_t offset = names.size();
-      names.resize(offset + header.name.size() + 1);
-      ::memcpy(names.data() + offset, header.name.data(),
-               header.name.size() + 1);
-
-      // Name the file with a reference to the name table.
-      header.name = base::StringPrintf("/%d", offset);
-    } else {
-      // Simply append a trailing '/' to the name.
-      header.name += "/";
-    }
-
-    // Fill in the raw file header.
-    if (!PopulateArFileHeader(header, &raw_header))
+    if (!PopulateObjectFileHeader(files_[i].first, &names, &raw_headers[i]))
       return false;
   }
 
-  // Open the file and write the global header.
+  // Open the file and write the headers.
   base::ScopedFILE file(base::OpenFile(path, "w+b"));
   if (file.get() == NULL) {
     LOG(ERROR) << "Unable to open file for writing: " << path.value();
     return false;
   }
-  if (::fwrite(kArGlobalMagic, sizeof(kArGlobalMagic), 1, file.get()) != 1) {
-    LOG(ERROR) << "Failed to write global archive header.";
-    return false;
-  }
 
   // Write the symbol tables. We initially use a set of dummy offsets, and
   // reach back and write the actual offsets once we've laid out the object
   // files.
   FileOffsets offsets(files_.size());
   base::Time timestamp = base::Time::Now();
-  uint32_t symbols1_pos = AlignAndGetPosition(file.get());
-  if (!WritePrimarySymbolTable(timestamp, symbols_, offsets, file.get()))
-    return false;
-  uint32_t symbols2_pos = AlignAndGetPosition(file.get());
-  if (!WriteSecondarySymbolTable(timestamp, symbols_, offsets, file.get()))
-    return false;
-
-  // Write the name table.
-  AlignAndGetPosition(file.get());
-  if (!WriteNameTable(timestamp, names, file.get()))
+  uint32_t symbols1_pos = 0;
+  uint32_t symbols2_pos = 0;
+  if (!WriteArchiveHeaders(timestamp, symbols_, offsets, names, file.get(),
+                           &symbols1_pos, &symbols2_pos)) {
     return false;
+  }
 
   // Write the files, keeping track of their offsets.
   for (size_t i = 0; i < files_.size(); ++i) {
@@ -669,25 +768,153 @@ bool ArWriter::Write(const base::FilePath& path) {
     const ArFileHeader& raw_header = raw_headers[i];
 
     offsets[i] = AlignAndGetPosition(file.get());
-    if (!WriteFile(raw_header, buffer, file.get()))
+    if (!WriteFile(raw_header, buffer.data(), buffer.size(), file.get()))
       return false;
   }
 
   // Rewrite the symbol streams using the actual file offsets this time around.
-  if (::fseek(file.get(), symbols1_pos, SEEK_SET) != 0) {
-    LOG(ERROR) << "Failed to seek to primary symbol stream.";
+  if (!RewriteSymbolTables(timestamp, symbols_, offsets, symbols1_pos,
+                           symbols2_pos, file.get())) {
+    return false;
+  }
+
+  return true;
+}
+
+ArStreamWriter::ArStreamWriter() {
+}
+
+ArStreamWriter::~ArStreamWriter() {
+  // Discard the spooled files of an archive that was never closed.
+  DiscardSpool();
+}
+
+bool ArStreamWriter::Open(const base::FilePath& path) {
+  DCHECK(path_.empty());
+  DCHECK(!path.empty());
+
+  // The spool is created alongside the archive, so that it lives on the same
+  // volume.
+  if (!base::CreateTemporaryFileInDir(path.DirName(), &spool_path_)) {
+    LOG(ERROR) << "Unable to create spool file for archive: " << path.value();
     return false;
   }
-  if (!WritePrimarySymbolTable(timestamp, symbols_, offsets, file.get()))
+  spool_.reset(base::OpenFile(spool_path_, "w+b"));
+  if (spool_.get() == NULL) {
+    LOG(ERROR) << "Unable to open spool file: " << spool_path_.value();
+    DiscardSpool();
     return false;
-  if (::fseek(file.get(), symbols2_pos, SEEK_SET) != 0) {
-    LOG(ERROR) << "Failed to seek to secondary symbol stream.";
+  }
+
+  path_ = path;
+  return true;
+}
+
+bool ArStreamWriter::AddFile(const base::StringPiece& filename,
+                             const base::Time& timestamp,
+                             uint32_t mode,
+                             const uint8_t* contents,
+                             size_t size) {
+  DCHECK(spool_.get() != NULL);
+
+  if (size == 0) {
+    LOG(ERROR) << "Unable to add empty file to archive: " << filename;
+    return false;
+  }
+  DCHECK_NE(reinterpret_cast<const uint8_t*>(NULL), contents);
+
+  // Build the file header.
+  ParsedArFileHeader header;
+  header.name = filename.as_string();
+  header.timestamp = timestamp;
+  header.mode = mode;
+  header.size = size;
+
+  // The name table is rolled back if the file is rejected.
+  size_t names_size = names_.size();
+  ArFileHeader raw_header;
+  if (!PopulateObjectFileHeader(header, &names_, &raw_header)) {
+    names_.resize(names_size);
+    return false;
+  }
+
+  if (!AddFileSymbols(offsets_.size(), header, contents, size, &symbols_,
+                      &weak_symbols_)) {
+    names_.resize(names_size);
+    return false;
+  }
+
+  // Spool the file. Files are aligned relative to the start of the spool,
+  // which itself will be aligned in the archive.
+  uint32_t offset = AlignAndGetPosition(spool_.get());
+  if (!WriteFile(raw_header, contents, size, spool_.get()))
+    return false;
+  offsets_.push_back(offset);
+
+  return true;
+}
+
+bool ArStreamWriter::Close() {
+  DCHECK(spool_.get() != NULL);
+
+  if (offsets_.empty()) {
+    LOG(ERROR) << "Unable to write an empty archive.";
+    return false;
+  }
+
+  // Now that all symbols are known the size of the symbol tables is fixed,
+  // and the object files can be laid out.
+  base::ScopedFILE file(base::OpenFile(path_, "w+b"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to open file for writing: " << path_.value();
     return false;
   }
-  if (!WriteSecondarySymbolTable(timestamp, symbols_, offsets, file.get()))
+  FileOffsets offsets(offsets_.size());
+  base::Time timestamp = base::Time::Now();
+  uint32_t symbols1_pos = 0;
+  uint32_t symbols2_pos = 0;
+  if (!WriteArchiveHeaders(timestamp, symbols_, offsets, names_, file.get(),
+                           &symbols1_pos, &symbols2_pos)) {
+    return false;
+  }
+  uint32_t files_pos = AlignAndGetPosition(file.get());
+  for (size_t i = 0; i < offsets_.size(); ++i)
+    offsets[i] = files_pos + offsets_[i];
+
+  // Append the spooled object files to the archive.
+  if (::fseek(spool_.get(), 0, SEEK_SET) != 0) {
+    LOG(ERROR) << "Failed to seek to the start of the spool file.";
+    return false;
+  }
+  std::vector<uint8_t> buffer(kCopyBufferSize);
+  while (true) {
+    size_t read = ::fread(buffer.data(), 1, buffer.size(), spool_.get());
+    if (read != 0 && ::fwrite(buffer.data(), 1, read, file.get()) != read) {
+      LOG(ERROR) << "Failed to write object files to archive.";
+      return false;
+    }
+    if (read < buffer.size())
+      break;
+  }
+  if (::ferror(spool_.get())) {
+    LOG(ERROR) << "Failed to read spool file: " << spool_path_.value();
+    return false;
+  }
+
+  if (!RewriteSymbolTables(timestamp, symbols_, offsets, symbols1_pos,
+                           symbols2_pos, file.get())) {
     return false;
+  }
 
+  DiscardSpool();
   return true;
 }
 
+void ArStreamWriter::DiscardSpool() {
+  spool_.reset();
+  if (!spool_path_.empty() && !base::DeleteFile(spool_path_, false))
+    LOG(WARNING) << "Unable to delete spool file: " << spool_path_.value();
+  spool_path_.clear();
+}
+
 }  // namespace ar
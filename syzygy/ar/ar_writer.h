@@ -21,6 +21,7 @@
 #include <set>
 
 #include "base/files/file_path.h"
+#include "base/files/file_util.h"
 #include "base/memory/scoped_vector.h"
 #include "syzygy/ar/ar_common.h"
 
@@ -90,6 +91,84 @@ class ArWriter {
   DISALLOW_COPY_AND_ASSIGN(ArWriter);
 };
 
+// Class for writing an archive of COFF object files without holding their
+// contents in memory. Files are spooled to a temporary file next to the
+// archive as they are added, while the symbol tables are built up
+// incrementally. Closing the writer writes the symbol tables followed by the
+// spooled files to the archive. Symbols are resolved exactly as by ArWriter.
+//
+// Usage:
+//   ArStreamWriter writer;
+//   if (!writer.Open(path))
+//     ...
+//   for (...) {
+//     if (!writer.AddFile(name, timestamp, mode, data, size))
+//       ...
+//   }
+//   if (!writer.Close())
+//     ...
+class ArStreamWriter {
+ public:
+  ArStreamWriter();
+  ~ArStreamWriter();
+
+  // @returns the number of files added to the archive so far.
+  size_t file_count() const { return offsets_.size(); }
+
+  // @returns the current set of exported symbols.
+  const SymbolIndexMap& symbols() const { return symbols_; }
+
+  // Prepares to write an archive. The archive itself is only created by
+  // Close.
+  // @param path The path of the archive file to be written.
+  // @returns true on success, false otherwise.
+  bool Open(const base::FilePath& path);
+
+  // Appends the given object file to the archive.
+  // @param filename The filename that will be associated with the content.
+  // @param timestamp The timestamp to be associated with the file.
+  // @param mode The mode to be associated with the file. In the same format
+  //     as ST_MODE from _wstat.
+  // @param contents The contents of the file. This need only remain valid for
+  //     the duration of the call.
+  // @param size The size of the contents, in bytes.
+  // @returns true on success, false otherwise.
+  bool AddFile(const base::StringPiece& filename,
+               const base::Time& timestamp,
+               uint32_t mode,
+               const uint8_t* contents,
+               size_t size);
+
+  // Writes the archive, and deletes the spooled files.
+  // @returns true on success, false otherwise.
+  bool Close();
+
+ protected:
+  // Closes and deletes the spool file, if any.
+  void DiscardSpool();
+
+  // The path of the archive being written.
+  base::FilePath path_;
+
+  // The file to which the object files are spooled, and its path.
+  base::FilePath spool_path_;
+  base::ScopedFILE spool_;
+
+  // The offsets of the spooled files, relative to the start of the spool.
+  std::vector<uint32_t> offsets_;
+
+  // The extended name table.
+  DataBuffer names_;
+
+  // The symbols exported from the files added so far, and the subset of them
+  // that are weak. See ArWriter.
+  SymbolIndexMap symbols_;
+  SymbolIndexMap weak_symbols_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ArStreamWriter);
+};
+
 }  // namespace ar
 
 #endif  // SYZYGY_AR_AR_WRITER_H_
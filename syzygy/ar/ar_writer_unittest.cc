@@ -14,6 +14,7 @@
 
 #include "syzygy/ar/ar_writer.h"
 
+#include "base/files/file_enumerator.h"
 #include "base/files/file_util.h"
 #include "base/memory/scoped_vector.h"
 #include "gmock/gmock.h"
@@ -196,6 +197,64 @@ TEST_F(ArWriterTest, TestArWriterRoundTripWeakSymbols) {
   EXPECT_THAT(reader2.symbols(), testing::ContainerEq(reader1.symbols()));
 }
 
+TEST_F(ArWriterTest, StreamWriterMatchesWriter) {
+  base::FilePath lib1 = testing::GetSrcRelativePath(testing::kArchiveFile);
+  ArReader reader1;
+  ASSERT_TRUE(reader1.Init(lib1));
+
+  base::FilePath lib2 = temp_dir_.Append(L"stream.lib");
+  ArStreamWriter writer;
+  ASSERT_TRUE(writer.Open(lib2));
+  for (size_t i = 0; i < reader1.offsets().size(); ++i) {
+    ParsedArFileHeader header;
+    const uint8_t* data = NULL;
+    ASSERT_TRUE(reader1.ExtractView(i, &header, &data));
+    EXPECT_TRUE(writer.AddFile(header.name, header.timestamp, header.mode,
+                               data, header.size));
+    EXPECT_EQ(i + 1, writer.file_count());
+  }
+  EXPECT_THAT(writer.symbols(), testing::ContainerEq(reader1.symbols()));
+  EXPECT_TRUE(writer.Close());
+
+  // Only the archive itself is left behind.
+  base::FileEnumerator enumerator(temp_dir_, false,
+                                  base::FileEnumerator::FILES);
+  EXPECT_EQ(lib2, enumerator.Next());
+  EXPECT_TRUE(enumerator.Next().empty());
+
+  ArReader reader2;
+  ASSERT_TRUE(reader2.Init(lib2));
+  EXPECT_THAT(reader2.symbols(), testing::ContainerEq(reader1.symbols()));
+  ASSERT_EQ(reader1.offsets().size(), reader2.offsets().size());
+  for (size_t i = 0; i < reader1.offsets().size(); ++i) {
+    ParsedArFileHeader header1;
+    ParsedArFileHeader header2;
+    DataBuffer data1;
+    DataBuffer data2;
+    EXPECT_TRUE(reader1.Extract(i, &header1, &data1));
+    EXPECT_TRUE(reader2.Extract(i, &header2, &data2));
+    EXPECT_EQ(header1.name, header2.name);
+    EXPECT_EQ(data1, data2);
+  }
+}
+
+TEST_F(ArWriterTest, StreamWriterRejectsInvalidFiles) {
+  base::FilePath lib = temp_dir_.Append(L"stream.lib");
+  ArStreamWriter writer;
+  ASSERT_TRUE(writer.Open(lib));
+
+  static const uint8_t kContent[] = "hey there";
+  EXPECT_FALSE(writer.AddFile("dummy.obj", base::Time::Now(), 0, kContent,
+                              arraysize(kContent)));
+  EXPECT_FALSE(writer.AddFile("empty.obj", base::Time::Now(), 0, kContent, 0));
+  EXPECT_EQ(0u, writer.file_count());
+  EXPECT_TRUE(writer.symbols().empty());
+
+  // An empty archive can't be written.
+  EXPECT_FALSE(writer.Close());
+  EXPECT_FALSE(base::PathExists(lib));
+}
+
 TEST_F(ArWriterTest, TestArWriterRoundTripRepeatedFileNames) {
   base::FilePath lib1 = testing::GetSrcRelativePath(
       testing::kDuplicatesArchiveFile);
@@ -27,6 +27,7 @@
         'buffer_serializer.h',
         'cond.h',
         'const.h',
+        'fixed_assembler.h',
         'label_base.h',
         'operand_base.h',
         'register_internal.h',
@@ -56,6 +57,7 @@
       'sources': [
         'assembler_unittest.cc',
         'buffer_serializer_unittest.cc',
+        'fixed_assembler_unittest.cc',
         'register_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
       ],
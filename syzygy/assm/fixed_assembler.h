@@ -0,0 +1,325 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file declares an assembler for the handful of instruction forms that
+// instrumentation emits over and over. The registers of each form are
+// template arguments, so that the opcode and Mod R/M bytes, as well as the
+// size of each instruction, are resolved at compile time.
+
+#ifndef SYZYGY_ASSM_FIXED_ASSEMBLER_H_
+#define SYZYGY_ASSM_FIXED_ASSEMBLER_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "syzygy/assm/assembler_base.h"
+#include "syzygy/assm/const.h"
+#include "syzygy/assm/register.h"
+
+namespace assm {
+
+// The encoding of a [base + disp32] or [disp32] memory operand, with
+// @p kRegOp in the reg/opcode field of the Mod R/M byte. This is the encoding
+// AssemblerBase uses for a 32-bit displacement.
+// @tparam kRegOp the register code or opcode extension.
+// @tparam kBase the base register, or kRegisterNone for [disp32].
+template <uint8_t kRegOp, RegisterId kBase>
+struct Disp32OperandEncoding {
+  static_assert(kRegOp < 8, "Invalid reg/opcode field.");
+  static_assert(kBase == kRegisterNone ||
+                    (kBase >= kRegister32Min && kBase < kRegister32Max),
+                "The base must be a 32-bit register.");
+
+  // [ESP + disp32] can only be encoded with a SIB byte, and [disp32] is
+  // encoded by overloading [EBP] with no displacement.
+  static const bool kHasSib = kBase == kRegisterEsp;
+  static const uint8_t kModRM = kBase == kRegisterNone ?
+      (kReg1Ind << 6) | (kRegOp << 3) | kRegisterCode101 :
+      (kReg1WordDisp << 6) | (kRegOp << 3) | (kBase & 0x7);
+  static const uint8_t kSib =
+      (kTimes1 << 6) | (kRegisterCode100 << 3) | kRegisterCode100;
+
+  // The size of the operand, Mod R/M byte included.
+  static const size_t kSize = 1 + (kHasSib ? 1 : 0) + 4;
+};
+
+// Assembles a sequence of fixed-form instructions into a presized buffer.
+// Unlike AssemblerBase, there is no per-instruction buffer and no serializer:
+// the bytes are written in place, and the references are accumulated with
+// their offsets relative to the start of the buffer. The bytes are identical
+// to those AssemblerBase produces for the same instructions.
+//
+// The size of a sequence is known at compile time, so a buffer can be sized
+// for a whole batch of sequences up front:
+//   const size_t kSequenceSize = Assembler::kPushImmediateSize +
+//                                Assembler::kCallIndirectSize;
+//   std::vector<uint8_t> buffer(count * kSequenceSize);
+//   Assembler assm(location, buffer.data(), buffer.size());
+//   for (size_t i = 0; i < count; ++i) {
+//     assm.push(Immediate(ids[i], kSize32Bit));
+//     assm.call(Displacement(hook_address, kSize32Bit, hook_ref));
+//   }
+// @tparam ReferenceType the type of the references, as for AssemblerBase.
+template <class ReferenceType>
+class FixedAssemblerBase {
+ public:
+  typedef AssemblerBase<ReferenceType> Assembler;
+  typedef typename Assembler::Displacement Displacement;
+  typedef typename Assembler::Immediate Immediate;
+  typedef typename Assembler::ReferenceInfo ReferenceInfo;
+
+  // @name The sizes of the fixed-form instructions.
+  // @{
+  static const size_t kPushRegisterSize = 1;
+  static const size_t kPushImmediateSize = 1 + 4;
+  static const size_t kCallIndirectSize =
+      1 + Disp32OperandEncoding<0x2, kRegisterNone>::kSize;
+  template <RegisterId kDst, RegisterId kBase>
+  struct LeaSize {
+    static const size_t value =
+        1 + Disp32OperandEncoding<kDst & 0x7, kBase>::kSize;
+  };
+  template <RegisterId kReg, RegisterId kBase>
+  struct MovSize {
+    // Moves between EAX and [disp32] have a special encoding.
+    static const size_t value =
+        kReg == kRegisterEax && kBase == kRegisterNone ?
+            1 + 4 : 1 + Disp32OperandEncoding<kReg & 0x7, kBase>::kSize;
+  };
+  // @}
+
+  // Constructs an assembler that assembles into @p buffer.
+  // @param location the address of the start of @p buffer.
+  // @param buffer the buffer receiving the instructions.
+  // @param size the size of @p buffer.
+  FixedAssemblerBase(uint32_t location, uint8_t* buffer, size_t size);
+
+  // Restarts assembly into another buffer, discarding the references. The
+  // capacity of the reference vector is kept, so that this can be used to
+  // assemble successive batches without reallocating.
+  // @param location the address of the start of @p buffer.
+  // @param buffer the buffer receiving the instructions.
+  // @param size the size of @p buffer.
+  void Reset(uint32_t location, uint8_t* buffer, size_t size);
+
+  // @name Accessors.
+  // @{
+  // @returns the location of the next instruction.
+  uint32_t location() const {
+    return location_ + static_cast<uint32_t>(len_);
+  }
+  // @returns the number of bytes assembled so far.
+  size_t len() const { return len_; }
+  // @returns the references of the instructions assembled so far, with their
+  //     offsets relative to the start of the buffer.
+  const std::vector<ReferenceInfo>& references() const { return references_; }
+  // @}
+
+  // Pushes the register @p kSrc.
+  template <RegisterId kSrc>
+  void push();
+
+  // Pushes a 32-bit immediate.
+  // @param src the immediate to push.
+  void push(const Immediate& src);
+
+  // Calls through a pointer at an absolute address, e.g. an import.
+  // @param dst the address of the pointer to the function to call.
+  void call(const Displacement& dst);
+
+  // Loads the address [kBase + disp32] into @p kDst.
+  // @param disp the 32-bit displacement.
+  template <RegisterId kDst, RegisterId kBase>
+  void lea(const Displacement& disp);
+
+  // Moves [kBase + disp32] into @p kDst.
+  // @param disp the 32-bit displacement.
+  template <RegisterId kDst, RegisterId kBase>
+  void mov_load(const Displacement& disp);
+
+  // Moves @p kSrc into [kBase + disp32].
+  // @param disp the 32-bit displacement.
+  template <RegisterId kBase, RegisterId kSrc>
+  void mov_store(const Displacement& disp);
+
+ private:
+  // Reserves @p size bytes of the buffer.
+  // @returns a pointer to the reserved bytes.
+  uint8_t* Reserve(size_t size);
+
+  // Writes the 32-bit @p value at @p data, recording @p reference if it's
+  // valid.
+  // @returns a pointer past the written bytes.
+  uint8_t* Emit32BitValue(uint32_t value,
+                          const ReferenceType& reference,
+                          uint8_t* data);
+
+  // Writes the encoding of the memory operand [kBase + disp32] at @p data.
+  // @returns a pointer past the written bytes.
+  template <uint8_t kRegOp, RegisterId kBase>
+  uint8_t* EmitDisp32Operand(const Displacement& disp, uint8_t* data);
+
+  // Writes an instruction made of @p opcode followed by the memory operand
+  // [kBase + disp32].
+  template <uint8_t kRegOp, RegisterId kBase>
+  void EmitDisp32Instruction(uint8_t opcode, const Displacement& disp);
+
+  uint32_t location_;
+  uint8_t* buffer_;
+  size_t size_;
+  size_t len_;
+  std::vector<ReferenceInfo> references_;
+
+  DISALLOW_COPY_AND_ASSIGN(FixedAssemblerBase);
+};
+
+// The fixed assembler counterpart of AssemblerImpl.
+typedef FixedAssemblerBase<const void*> FixedAssemblerImpl;
+
+template <class ReferenceType>
+FixedAssemblerBase<ReferenceType>::FixedAssemblerBase(uint32_t location,
+                                                      uint8_t* buffer,
+                                                      size_t size)
+    : location_(location), buffer_(buffer), size_(size), len_(0) {
+  DCHECK(buffer != NULL || size == 0);
+}
+
+template <class ReferenceType>
+void FixedAssemblerBase<ReferenceType>::Reset(uint32_t location,
+                                              uint8_t* buffer,
+                                              size_t size) {
+  DCHECK(buffer != NULL || size == 0);
+  location_ = location;
+  buffer_ = buffer;
+  size_ = size;
+  len_ = 0;
+  references_.clear();
+}
+
+template <class ReferenceType>
+template <RegisterId kSrc>
+void FixedAssemblerBase<ReferenceType>::push() {
+  static_assert(kSrc >= kRegister32Min && kSrc < kRegister32Max,
+                "Only 32-bit registers can be pushed.");
+  uint8_t* data = Reserve(kPushRegisterSize);
+  data[0] = 0x50 | (kSrc & 0x7);
+}
+
+template <class ReferenceType>
+void FixedAssemblerBase<ReferenceType>::push(const Immediate& src) {
+  DCHECK_EQ(kSize32Bit, src.size());
+  uint8_t* data = Reserve(kPushImmediateSize);
+  data[0] = 0x68;
+  Emit32BitValue(src.value(), src.reference(), data + 1);
+}
+
+template <class ReferenceType>
+void FixedAssemblerBase<ReferenceType>::call(const Displacement& dst) {
+  EmitDisp32Instruction<0x2, kRegisterNone>(0xFF, dst);
+}
+
+template <class ReferenceType>
+template <RegisterId kDst, RegisterId kBase>
+void FixedAssemblerBase<ReferenceType>::lea(const Displacement& disp) {
+  static_assert(kDst >= kRegister32Min && kDst < kRegister32Max,
+                "The destination must be a 32-bit register.");
+  EmitDisp32Instruction<kDst & 0x7, kBase>(0x8D, disp);
+}
+
+template <class ReferenceType>
+template <RegisterId kDst, RegisterId kBase>
+void FixedAssemblerBase<ReferenceType>::mov_load(const Displacement& disp) {
+  static_assert(kDst >= kRegister32Min && kDst < kRegister32Max,
+                "The destination must be a 32-bit register.");
+  if (kDst == kRegisterEax && kBase == kRegisterNone) {
+    uint8_t* data = Reserve(MovSize<kDst, kBase>::value);
+    data[0] = 0xA1;
+    Emit32BitValue(disp.value(), disp.reference(), data + 1);
+  } else {
+    EmitDisp32Instruction<kDst & 0x7, kBase>(0x8B, disp);
+  }
+}
+
+template <class ReferenceType>
+template <RegisterId kBase, RegisterId kSrc>
+void FixedAssemblerBase<ReferenceType>::mov_store(const Displacement& disp) {
+  static_assert(kSrc >= kRegister32Min && kSrc < kRegister32Max,
+                "The source must be a 32-bit register.");
+  if (kSrc == kRegisterEax && kBase == kRegisterNone) {
+    uint8_t* data = Reserve(MovSize<kSrc, kBase>::value);
+    data[0] = 0xA3;
+    Emit32BitValue(disp.value(), disp.reference(), data + 1);
+  } else {
+    EmitDisp32Instruction<kSrc & 0x7, kBase>(0x89, disp);
+  }
+}
+
+template <class ReferenceType>
+uint8_t* FixedAssemblerBase<ReferenceType>::Reserve(size_t size) {
+  DCHECK_LE(len_ + size, size_);
+  uint8_t* data = buffer_ + len_;
+  len_ += size;
+  return data;
+}
+
+template <class ReferenceType>
+uint8_t* FixedAssemblerBase<ReferenceType>::Emit32BitValue(
+    uint32_t value,
+    const ReferenceType& reference,
+    uint8_t* data) {
+  if (details::IsValidReference(reference)) {
+    ReferenceInfo info = {};
+    info.offset = data - buffer_;
+    info.reference = reference;
+    info.size = kSize32Bit;
+    info.pc_relative = false;
+    references_.push_back(info);
+  }
+
+  data[0] = static_cast<uint8_t>(value);
+  data[1] = static_cast<uint8_t>(value >> 8);
+  data[2] = static_cast<uint8_t>(value >> 16);
+  data[3] = static_cast<uint8_t>(value >> 24);
+  return data + 4;
+}
+
+template <class ReferenceType>
+template <uint8_t kRegOp, RegisterId kBase>
+uint8_t* FixedAssemblerBase<ReferenceType>::EmitDisp32Operand(
+    const Displacement& disp,
+    uint8_t* data) {
+  typedef Disp32OperandEncoding<kRegOp, kBase> Encoding;
+  DCHECK_EQ(kSize32Bit, disp.size());
+
+  *data++ = Encoding::kModRM;
+  if (Encoding::kHasSib)
+    *data++ = Encoding::kSib;
+  return Emit32BitValue(disp.value(), disp.reference(), data);
+}
+
+template <class ReferenceType>
+template <uint8_t kRegOp, RegisterId kBase>
+void FixedAssemblerBase<ReferenceType>::EmitDisp32Instruction(
+    uint8_t opcode,
+    const Displacement& disp) {
+  uint8_t* data = Reserve(1 + Disp32OperandEncoding<kRegOp, kBase>::kSize);
+  data[0] = opcode;
+  EmitDisp32Operand<kRegOp, kBase>(disp, data + 1);
+}
+
+}  // namespace assm
+
+#endif  // SYZYGY_ASSM_FIXED_ASSEMBLER_H_
@@ -0,0 +1,196 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/assm/fixed_assembler.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "syzygy/assm/assembler.h"
+
+namespace assm {
+
+namespace {
+
+typedef AssemblerImpl::Displacement Displacement;
+typedef AssemblerImpl::Immediate Immediate;
+typedef AssemblerImpl::Operand Operand;
+typedef FixedAssemblerImpl::ReferenceInfo ReferenceInfo;
+
+// Collects the output of an AssemblerImpl, with reference offsets relative to
+// the start of the code.
+class CollectingSerializer : public AssemblerImpl::InstructionSerializer {
+ public:
+  void AppendInstruction(uint32_t location,
+                         const uint8_t* bytes,
+                         uint32_t num_bytes,
+                         const ReferenceInfo* refs,
+                         size_t num_refs) override {
+    for (size_t i = 0; i < num_refs; ++i) {
+      ReferenceInfo ref = refs[i];
+      ref.offset += code.size();
+      references.push_back(ref);
+    }
+    code.insert(code.end(), bytes, bytes + num_bytes);
+  }
+
+  bool FinalizeLabel(uint32_t location,
+                     const uint8_t* bytes,
+                     size_t num_bytes) override {
+    return false;
+  }
+
+  std::vector<uint8_t> code;
+  std::vector<ReferenceInfo> references;
+};
+
+class FixedAssemblerTest : public testing::Test {
+ public:
+  static const uint32_t kLocation = 0x10000000;
+
+  FixedAssemblerTest()
+      : buffer_(64, 0xCC),
+        asm_(kLocation, &serializer_),
+        fixed_asm_(kLocation, buffer_.data(), buffer_.size()) {
+  }
+
+  // Checks that both assemblers produced the same code and references.
+  void ExpectSameOutput() {
+    ASSERT_EQ(serializer_.code.size(), fixed_asm_.len());
+    EXPECT_EQ(0, ::memcmp(serializer_.code.data(), buffer_.data(),
+                          fixed_asm_.len()));
+    EXPECT_EQ(asm_.location(), fixed_asm_.location());
+
+    const std::vector<ReferenceInfo>& refs = fixed_asm_.references();
+    ASSERT_EQ(serializer_.references.size(), refs.size());
+    for (size_t i = 0; i < refs.size(); ++i) {
+      EXPECT_EQ(serializer_.references[i].offset, refs[i].offset);
+      EXPECT_EQ(serializer_.references[i].reference, refs[i].reference);
+      EXPECT_EQ(serializer_.references[i].size, refs[i].size);
+      EXPECT_EQ(serializer_.references[i].pc_relative, refs[i].pc_relative);
+    }
+  }
+
+  // Resets both assemblers.
+  void Reset() {
+    serializer_.code.clear();
+    serializer_.references.clear();
+    asm_.set_location(kLocation);
+    fixed_asm_.Reset(kLocation, buffer_.data(), buffer_.size());
+  }
+
+  template <RegisterId kBase>
+  void TestDisp32Forms(const Register32& base) {
+    const Displacement disp(0xCAFEBABE, kSize32Bit, &buffer_);
+    Operand op = kBase == kRegisterNone ?
+        Operand(disp) : Operand(base, disp);
+
+    Reset();
+    asm_.lea(ecx, op);
+    fixed_asm_.lea<kRegisterEcx, kBase>(disp);
+    EXPECT_EQ((FixedAssemblerImpl::LeaSize<kRegisterEcx, kBase>::value),
+              fixed_asm_.len());
+    ExpectSameOutput();
+
+    Reset();
+    asm_.mov(eax, op);
+    asm_.mov(edi, op);
+    fixed_asm_.mov_load<kRegisterEax, kBase>(disp);
+    fixed_asm_.mov_load<kRegisterEdi, kBase>(disp);
+    EXPECT_EQ((FixedAssemblerImpl::MovSize<kRegisterEax, kBase>::value +
+               FixedAssemblerImpl::MovSize<kRegisterEdi, kBase>::value),
+              fixed_asm_.len());
+    ExpectSameOutput();
+
+    Reset();
+    asm_.mov(op, eax);
+    asm_.mov(op, edx);
+    fixed_asm_.mov_store<kBase, kRegisterEax>(disp);
+    fixed_asm_.mov_store<kBase, kRegisterEdx>(disp);
+    EXPECT_EQ((FixedAssemblerImpl::MovSize<kRegisterEax, kBase>::value +
+               FixedAssemblerImpl::MovSize<kRegisterEdx, kBase>::value),
+              fixed_asm_.len());
+    ExpectSameOutput();
+  }
+
+  std::vector<uint8_t> buffer_;
+  CollectingSerializer serializer_;
+  AssemblerImpl asm_;
+  FixedAssemblerImpl fixed_asm_;
+};
+
+}  // namespace
+
+TEST_F(FixedAssemblerTest, Push) {
+  asm_.push(eax);
+  asm_.push(esp);
+  asm_.push(edi);
+  asm_.push(Immediate(0xCAFEBABE, kSize32Bit));
+  asm_.push(Immediate(0xDEADBEEF, kSize32Bit, &buffer_));
+  fixed_asm_.push<kRegisterEax>();
+  fixed_asm_.push<kRegisterEsp>();
+  fixed_asm_.push<kRegisterEdi>();
+  fixed_asm_.push(Immediate(0xCAFEBABE, kSize32Bit));
+  fixed_asm_.push(Immediate(0xDEADBEEF, kSize32Bit, &buffer_));
+  EXPECT_EQ(3 * FixedAssemblerImpl::kPushRegisterSize +
+                2 * FixedAssemblerImpl::kPushImmediateSize,
+            fixed_asm_.len());
+  ExpectSameOutput();
+}
+
+TEST_F(FixedAssemblerTest, CallIndirect) {
+  const Displacement disp(0xCAFEBABE, kSize32Bit, &buffer_);
+  asm_.call(Operand(disp));
+  fixed_asm_.call(disp);
+  EXPECT_EQ(FixedAssemblerImpl::kCallIndirectSize, fixed_asm_.len());
+  ExpectSameOutput();
+}
+
+TEST_F(FixedAssemblerTest, Disp32Forms) {
+  TestDisp32Forms<kRegisterNone>(eax);
+  TestDisp32Forms<kRegisterEax>(eax);
+  TestDisp32Forms<kRegisterEbx>(ebx);
+  TestDisp32Forms<kRegisterEsp>(esp);
+  TestDisp32Forms<kRegisterEbp>(ebp);
+}
+
+TEST_F(FixedAssemblerTest, BatchIntoPresizedBuffer) {
+  const size_t kSequenceSize = FixedAssemblerImpl::kPushImmediateSize +
+                               FixedAssemblerImpl::kCallIndirectSize;
+  const size_t kCount = 100;
+  const Displacement hook(0xCAFEBABE, kSize32Bit, &buffer_);
+
+  std::vector<uint8_t> batch(kCount * kSequenceSize);
+  FixedAssemblerImpl batch_asm(kLocation, batch.data(), batch.size());
+  for (size_t i = 0; i < kCount; ++i) {
+    asm_.push(Immediate(i, kSize32Bit));
+    asm_.call(Operand(hook));
+    batch_asm.push(Immediate(i, kSize32Bit));
+    batch_asm.call(hook);
+  }
+
+  // The batch fills the buffer exactly.
+  ASSERT_EQ(batch.size(), batch_asm.len());
+  ASSERT_EQ(serializer_.code.size(), batch.size());
+  EXPECT_EQ(0, ::memcmp(serializer_.code.data(), batch.data(), batch.size()));
+
+  // One reference per call, at offsets relative to the start of the buffer.
+  ASSERT_EQ(kCount, batch_asm.references().size());
+  for (size_t i = 0; i < kCount; ++i) {
+    EXPECT_EQ(serializer_.references[i].offset,
+              batch_asm.references()[i].offset);
+  }
+}
+
+}  // namespace assm
@@ -14,10 +14,13 @@
 
 #include "syzygy/bard/events/linked_event.h"
 
+#include <windows.h>
+
 namespace bard {
 namespace events {
 
-LinkedEvent::LinkedEvent(std::unique_ptr<EventInterface> event) {
+LinkedEvent::LinkedEvent(std::unique_ptr<EventInterface> event)
+    : played_(0), waiters_(0) {
   DCHECK_NE(static_cast<EventInterface*>(nullptr), event.get());
   event_ = std::move(event);
 }
@@ -25,20 +28,23 @@ LinkedEvent::LinkedEvent(std::unique_ptr<EventInterface> event) {
 bool LinkedEvent::Play(void* backdrop) {
   DCHECK_NE(static_cast<void*>(nullptr), backdrop);
 
-  for (auto& dep : deps_) {
-    DCHECK_NE(static_cast<base::WaitableEvent*>(nullptr),
-              dep->waitable_event_.get());
-    dep->waitable_event_->Wait();
-  }
+  for (auto& dep : deps_)
+    dep->WaitUntilPlayed();
 
   // Play the wrapped event.
   if (!event_->Play(backdrop))
     return false;
 
   // If this LinkedEvent is itself an input dependency of another
-  // LinkedEvent then fire the signal.
-  if (waitable_event_.get())
-    waitable_event_->Signal();
+  // LinkedEvent then fire the signal, but only if one of them gave up
+  // spinning. The barrier orders the store of played_ before the load of
+  // waiters_, pairing with the one in WaitUntilPlayed.
+  if (waitable_event_.get()) {
+    base::subtle::Release_Store(&played_, 1);
+    base::subtle::MemoryBarrier();
+    if (base::subtle::Acquire_Load(&waiters_) != 0)
+      waitable_event_->Signal();
+  }
 
   return true;
 }
@@ -99,5 +105,23 @@ bool LinkedEvent::AddDep(EventInterface* dep) {
   return true;
 }
 
+void LinkedEvent::WaitUntilPlayed() {
+  DCHECK_NE(static_cast<base::WaitableEvent*>(nullptr),
+            waitable_event_.get());
+
+  for (size_t i = 0; i < kSpinCount; ++i) {
+    if (base::subtle::Acquire_Load(&played_) != 0)
+      return;
+    ::YieldProcessor();
+  }
+
+  // Announce the wait before checking one last time, so that either this
+  // sees played_ or the player sees waiters_ and signals.
+  base::subtle::Barrier_AtomicIncrement(&waiters_, 1);
+  if (base::subtle::Acquire_Load(&played_) != 0)
+    return;
+  waitable_event_->Wait();
+}
+
 }  // namespace events
 }  // namespace bard
@@ -20,6 +20,7 @@
 #include <memory>
 #include <set>
 
+#include "base/atomicops.h"
 #include "base/synchronization/waitable_event.h"
 #include "syzygy/bard/event.h"
 
@@ -65,6 +66,21 @@ class LinkedEvent : public EventInterface {
   // @}
 
  private:
+  // The number of times a dependent event polls this one before blocking on
+  // its waitable event. Most dependencies are played by another plot line
+  // moments before they are needed, so spinning briefly spares the waiter a
+  // trip through the kernel.
+  static const size_t kSpinCount = 4096;
+
+  // Waits for this event to have been played.
+  void WaitUntilPlayed();
+
+  // Set once this event has been played.
+  base::subtle::Atomic32 played_;
+  // The number of dependent events blocked, or about to block, on
+  // waitable_event_. The event is only signaled if this is non-zero.
+  base::subtle::Atomic32 waiters_;
+
   // This is only allocated if this event becomes an output dependency of any
   // others.
   std::unique_ptr<base::WaitableEvent> waitable_event_;
@@ -191,5 +191,28 @@ TEST_F(LinkedEventTest, TestMultipleDependency) {
       reinterpret_cast<const TestEvent*>(linked_event3_.event())->played());
 }
 
+TEST_F(LinkedEventTest, TestDependencyAlreadyPlayed) {
+  base::DelegateSimpleThread thread1(&runner1_, "First Thread");
+  base::DelegateSimpleThread thread2(&runner2_, "Second Thread");
+
+  linked_event2_.AddDep(&linked_event1_);
+
+  // The dependency is played before the dependent event waits on it, which
+  // must not block.
+  thread1.Start();
+  thread1.Join();
+
+  EXPECT_TRUE(
+      reinterpret_cast<const TestEvent*>(linked_event1_.event())->played());
+  EXPECT_FALSE(
+      reinterpret_cast<const TestEvent*>(linked_event2_.event())->played());
+
+  thread2.Start();
+  thread2.Join();
+
+  EXPECT_TRUE(
+      reinterpret_cast<const TestEvent*>(linked_event2_.event())->played());
+}
+
 }  // namespace events
 }  // namespace bard
@@ -0,0 +1,658 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/bard/mapped_story.h"
+
+#include <windows.h>
+
+#include <limits>
+#include <map>
+
+#include "base/atomicops.h"
+#include "base/files/file_util.h"
+#include "base/memory/scoped_vector.h"
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
+#include "syzygy/bard/events/heap_alloc_event.h"
+#include "syzygy/bard/events/heap_create_event.h"
+#include "syzygy/bard/events/heap_destroy_event.h"
+#include "syzygy/bard/events/heap_free_event.h"
+#include "syzygy/bard/events/heap_realloc_event.h"
+#include "syzygy/bard/events/heap_set_information_event.h"
+#include "syzygy/bard/events/heap_size_event.h"
+#include "syzygy/bard/events/linked_event.h"
+
+namespace bard {
+
+namespace {
+
+using events::LinkedEvent;
+
+// The arrays of the file are laid out back to back, so they stay 8-byte
+// aligned as long as their elements are.
+static_assert(sizeof(MappedStoryFileHeader) % 8 == 0,
+              "MappedStoryFileHeader breaks the alignment.");
+static_assert(sizeof(MappedStoryHeader) % 8 == 0,
+              "MappedStoryHeader breaks the alignment.");
+static_assert(sizeof(MappedPlotLine) % 8 == 0,
+              "MappedPlotLine breaks the alignment.");
+static_assert(sizeof(MappedEvent) % 8 == 0,
+              "MappedEvent breaks the alignment.");
+static_assert(sizeof(MappedDep) % 8 == 0, "MappedDep breaks the alignment.");
+
+// The number of times a plot line polls a constraint before yielding, and
+// then before sleeping, while it waits for another plot line.
+const size_t kSpinCount = 4096;
+const size_t kYieldCount = 64;
+
+// Maps each of the linked events of a story to its ID.
+using LinkedEventIds = std::map<const LinkedEvent*, MappedDep>;
+
+void IndexLinkedEvents(const Story& story, LinkedEventIds* ids) {
+  DCHECK_NE(static_cast<LinkedEventIds*>(nullptr), ids);
+  for (size_t i = 0; i < story.plot_lines().size(); ++i) {
+    const Story::PlotLine* plot_line = story.plot_lines()[i];
+    for (size_t j = 0; j < plot_line->size(); ++j) {
+      const EventInterface* event = (*plot_line)[j];
+      if (event->type() != EventInterface::kLinkedEvent)
+        continue;
+      MappedDep id = { static_cast<uint32_t>(i), static_cast<uint32_t>(j) };
+      (*ids)[reinterpret_cast<const LinkedEvent*>(event)] = id;
+    }
+  }
+}
+
+template <typename T>
+uint64_t FromPointer(T pointer) {
+  return reinterpret_cast<uintptr_t>(pointer);
+}
+
+template <typename T>
+T ToPointer(uint64_t value) {
+  return reinterpret_cast<T>(static_cast<uintptr_t>(value));
+}
+
+// Encodes the type and the arguments of an event.
+// @returns false if @p event is not a heap event.
+bool EncodeEvent(const EventInterface* event, MappedEvent* record) {
+  DCHECK_NE(static_cast<const EventInterface*>(nullptr), event);
+  DCHECK_NE(static_cast<MappedEvent*>(nullptr), record);
+
+  record->type = event->type();
+  uint64_t* args = record->args;
+  switch (event->type()) {
+    case EventInterface::kHeapAllocEvent: {
+      const auto* e = reinterpret_cast<const events::HeapAllocEvent*>(event);
+      record->stack_trace_id = e->stack_trace_id();
+      args[0] = FromPointer(e->trace_heap());
+      args[1] = e->flags();
+      args[2] = e->bytes();
+      args[3] = FromPointer(e->trace_alloc());
+      return true;
+    }
+
+    case EventInterface::kHeapCreateEvent: {
+      const auto* e = reinterpret_cast<const events::HeapCreateEvent*>(event);
+      record->stack_trace_id = e->stack_trace_id();
+      args[0] = e->options();
+      args[1] = e->initial_size();
+      args[2] = e->maximum_size();
+      args[3] = FromPointer(e->trace_heap());
+      return true;
+    }
+
+    case EventInterface::kHeapDestroyEvent: {
+      const auto* e = reinterpret_cast<const events::HeapDestroyEvent*>(event);
+      record->stack_trace_id = e->stack_trace_id();
+      args[0] = FromPointer(e->trace_heap());
+      args[1] = e->trace_succeeded();
+      return true;
+    }
+
+    case EventInterface::kHeapFreeEvent: {
+      const auto* e = reinterpret_cast<const events::HeapFreeEvent*>(event);
+      record->stack_trace_id = e->stack_trace_id();
+      args[0] = FromPointer(e->trace_heap());
+      args[1] = e->flags();
+      args[2] = FromPointer(e->trace_alloc());
+      args[3] = e->trace_succeeded();
+      return true;
+    }
+
+    case EventInterface::kHeapReAllocEvent: {
+      const auto* e = reinterpret_cast<const events::HeapReAllocEvent*>(event);
+      record->stack_trace_id = e->stack_trace_id();
+      args[0] = FromPointer(e->trace_heap());
+      args[1] = e->flags();
+      args[2] = FromPointer(e->trace_alloc());
+      args[3] = e->bytes();
+      args[4] = FromPointer(e->trace_realloc());
+      return true;
+    }
+
+    case EventInterface::kHeapSetInformationEvent: {
+      const auto* e =
+          reinterpret_cast<const events::HeapSetInformationEvent*>(event);
+      record->stack_trace_id = e->stack_trace_id();
+      args[0] = FromPointer(e->trace_heap());
+      args[1] = e->info_class();
+      args[2] = FromPointer(e->info());
+      args[3] = e->info_length();
+      args[4] = e->trace_succeeded();
+      return true;
+    }
+
+    case EventInterface::kHeapSizeEvent: {
+      const auto* e = reinterpret_cast<const events::HeapSizeEvent*>(event);
+      record->stack_trace_id = e->stack_trace_id();
+      args[0] = FromPointer(e->trace_heap());
+      args[1] = e->flags();
+      args[2] = FromPointer(e->trace_alloc());
+      args[3] = e->trace_size();
+      return true;
+    }
+
+    default:
+      break;
+  }
+
+  LOG(ERROR) << "Events of type " << event->type() << " can't be mapped.";
+  return false;
+}
+
+// Decodes an event record into a temporary event, and invokes a functor on
+// it. The event only lives for the duration of the call, which spares the
+// playback an allocation per event.
+// @tparam Functor the type of the functor, which is invoked with an
+//     EventInterface* and returns a bool.
+// @returns the value returned by the functor.
+template <typename Functor>
+bool VisitEvent(const MappedEvent& record, Functor* functor) {
+  DCHECK_NE(static_cast<Functor*>(nullptr), functor);
+
+  const uint64_t* args = record.args;
+  switch (record.type) {
+    case EventInterface::kHeapAllocEvent: {
+      events::HeapAllocEvent event(
+          record.stack_trace_id, ToPointer<HANDLE>(args[0]),
+          static_cast<DWORD>(args[1]), static_cast<SIZE_T>(args[2]),
+          ToPointer<LPVOID>(args[3]));
+      return (*functor)(&event);
+    }
+
+    case EventInterface::kHeapCreateEvent: {
+      events::HeapCreateEvent event(
+          record.stack_trace_id, static_cast<DWORD>(args[0]),
+          static_cast<SIZE_T>(args[1]), static_cast<SIZE_T>(args[2]),
+          ToPointer<HANDLE>(args[3]));
+      return (*functor)(&event);
+    }
+
+    case EventInterface::kHeapDestroyEvent: {
+      events::HeapDestroyEvent event(record.stack_trace_id,
+                                     ToPointer<HANDLE>(args[0]),
+                                     static_cast<BOOL>(args[1]));
+      return (*functor)(&event);
+    }
+
+    case EventInterface::kHeapFreeEvent: {
+      events::HeapFreeEvent event(
+          record.stack_trace_id, ToPointer<HANDLE>(args[0]),
+          static_cast<DWORD>(args[1]), ToPointer<LPVOID>(args[2]),
+          static_cast<BOOL>(args[3]));
+      return (*functor)(&event);
+    }
+
+    case EventInterface::kHeapReAllocEvent: {
+      events::HeapReAllocEvent event(
+          record.stack_trace_id, ToPointer<HANDLE>(args[0]),
+          static_cast<DWORD>(args[1]), ToPointer<LPVOID>(args[2]),
+          static_cast<SIZE_T>(args[3]), ToPointer<LPVOID>(args[4]));
+      return (*functor)(&event);
+    }
+
+    case EventInterface::kHeapSetInformationEvent: {
+      events::HeapSetInformationEvent event(
+          record.stack_trace_id, ToPointer<HANDLE>(args[0]),
+          static_cast<HEAP_INFORMATION_CLASS>(args[1]),
+          ToPointer<PVOID>(args[2]), static_cast<SIZE_T>(args[3]),
+          static_cast<BOOL>(args[4]));
+      return (*functor)(&event);
+    }
+
+    case EventInterface::kHeapSizeEvent: {
+      events::HeapSizeEvent event(
+          record.stack_trace_id, ToPointer<HANDLE>(args[0]),
+          static_cast<DWORD>(args[1]), ToPointer<LPCVOID>(args[2]),
+          static_cast<SIZE_T>(args[3]));
+      return (*functor)(&event);
+    }
+
+    default:
+      break;
+  }
+
+  NOTREACHED() << "Invalid event types are rejected when the file is opened.";
+  return false;
+}
+
+// Plays the events it is invoked on.
+class PlayFunctor {
+ public:
+  explicit PlayFunctor(void* backdrop) : backdrop_(backdrop) {}
+
+  bool operator()(EventInterface* event) { return event->Play(backdrop_); }
+
+ private:
+  void* backdrop_;
+};
+
+// Compares the events it is invoked on to an expected event.
+class EqualsFunctor {
+ public:
+  explicit EqualsFunctor(const EventInterface* expected)
+      : expected_(expected) {}
+
+  bool operator()(EventInterface* event) { return event->Equals(expected_); }
+
+ private:
+  const EventInterface* expected_;
+};
+
+// The state shared by the plot lines of a story being played.
+struct PlayState {
+  explicit PlayState(size_t plot_line_count)
+      : played(plot_line_count, 0), failed(0) {}
+
+  // The number of events played by each of the plot lines.
+  std::vector<base::subtle::Atomic32> played;
+  // Set when a plot line fails, so that the others give up.
+  base::subtle::Atomic32 failed;
+};
+
+// Waits for an event to have been played by its plot line.
+// @returns true once the event has been played, or false if the playback
+//     failed in the meantime.
+bool WaitForEvent(const MappedDep& dep, PlayState* state) {
+  for (size_t i = 0; ; ++i) {
+    uint32_t played = static_cast<uint32_t>(
+        base::subtle::Acquire_Load(&state->played[dep.plot_line]));
+    if (played > dep.event)
+      return true;
+    if (base::subtle::Acquire_Load(&state->failed) != 0)
+      return false;
+
+    if (i < kSpinCount) {
+      ::YieldProcessor();
+    } else if (i < kSpinCount + kYieldCount) {
+      base::PlatformThread::YieldCurrentThread();
+    } else {
+      base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(1));
+    }
+  }
+}
+
+// Gets an array of a mapped file.
+// @returns true on success, false if the array isn't entirely in the file.
+template <typename T>
+bool GetArray(const uint8_t* data,
+              size_t size,
+              uint64_t offset,
+              uint32_t count,
+              const T** array) {
+  if (offset % 8 != 0 || offset > size ||
+      count > (size - static_cast<size_t>(offset)) / sizeof(T)) {
+    return false;
+  }
+  *array = reinterpret_cast<const T*>(data + static_cast<size_t>(offset));
+  return true;
+}
+
+// Writes an array to a file.
+template <typename T>
+bool WriteArray(const std::vector<T>& array, FILE* file) {
+  if (array.empty())
+    return true;
+  return ::fwrite(array.data(), sizeof(T), array.size(), file) ==
+         array.size();
+}
+
+}  // namespace
+
+bool MappedStoryWriter::AddStory(const Story* story,
+                                 const std::vector<uintptr_t>& trace_heaps) {
+  DCHECK_NE(static_cast<const Story*>(nullptr), story);
+
+  FlatStory flat;
+  flat.heaps.assign(trace_heaps.begin(), trace_heaps.end());
+
+  LinkedEventIds ids;
+  IndexLinkedEvents(*story, &ids);
+
+  for (const Story::PlotLine* plot_line : story->plot_lines()) {
+    MappedPlotLine mapped_plot_line = {
+        static_cast<uint32_t>(flat.events.size()),
+        static_cast<uint32_t>(plot_line->size()) };
+    flat.plot_lines.push_back(mapped_plot_line);
+
+    for (const EventInterface* event : *plot_line) {
+      MappedEvent record = {};
+      record.first_dep = static_cast<uint32_t>(flat.deps.size());
+      if (event->type() == EventInterface::kLinkedEvent) {
+        const auto* linked = reinterpret_cast<const LinkedEvent*>(event);
+        for (const LinkedEvent* dep : linked->deps()) {
+          auto it = ids.find(dep);
+          if (it == ids.end()) {
+            LOG(ERROR) << "A constraint refers to an event of another story.";
+            return false;
+          }
+          flat.deps.push_back(it->second);
+        }
+        record.dep_count = static_cast<uint32_t>(linked->deps().size());
+        event = linked->event();
+      }
+      if (!EncodeEvent(event, &record))
+        return false;
+      flat.events.push_back(record);
+    }
+  }
+
+  const uint32_t kMaxCount = std::numeric_limits<uint32_t>::max();
+  if (flat.heaps.size() > kMaxCount || flat.plot_lines.size() > kMaxCount ||
+      flat.events.size() > kMaxCount || flat.deps.size() > kMaxCount) {
+    LOG(ERROR) << "The story is too large to be mapped.";
+    return false;
+  }
+
+  stories_.push_back(flat);
+  return true;
+}
+
+bool MappedStoryWriter::Write(FILE* file) const {
+  DCHECK_NE(static_cast<FILE*>(nullptr), file);
+
+  MappedStoryFileHeader file_header = {};
+  file_header.magic = MappedStoryFileHeader::kMagic;
+  file_header.version = MappedStoryFileHeader::kVersion;
+  file_header.story_count = static_cast<uint32_t>(stories_.size());
+
+  // Lay out the arrays of the stories after the headers.
+  std::vector<MappedStoryHeader> headers(stories_.size());
+  uint64_t offset = sizeof(file_header) + headers.size() * sizeof(headers[0]);
+  for (size_t i = 0; i < stories_.size(); ++i) {
+    const FlatStory& story = stories_[i];
+    MappedStoryHeader& header = headers[i];
+    header.heap_count = static_cast<uint32_t>(story.heaps.size());
+    header.plot_line_count = static_cast<uint32_t>(story.plot_lines.size());
+    header.event_count = static_cast<uint32_t>(story.events.size());
+    header.dep_count = static_cast<uint32_t>(story.deps.size());
+
+    header.heaps_offset = offset;
+    offset += story.heaps.size() * sizeof(story.heaps[0]);
+    header.plot_lines_offset = offset;
+    offset += story.plot_lines.size() * sizeof(MappedPlotLine);
+    header.events_offset = offset;
+    offset += story.events.size() * sizeof(MappedEvent);
+    header.deps_offset = offset;
+    offset += story.deps.size() * sizeof(MappedDep);
+  }
+
+  if (::fwrite(&file_header, sizeof(file_header), 1, file) != 1 ||
+      !WriteArray(headers, file)) {
+    LOG(ERROR) << "Failed to write the headers of the mapped stories.";
+    return false;
+  }
+  for (const FlatStory& story : stories_) {
+    if (!WriteArray(story.heaps, file) ||
+        !WriteArray(story.plot_lines, file) ||
+        !WriteArray(story.events, file) || !WriteArray(story.deps, file)) {
+      LOG(ERROR) << "Failed to write a mapped story.";
+      return false;
+    }
+  }
+
+  return ::fflush(file) == 0;
+}
+
+// Plays a plot line of a mapped story on a thread of its own.
+class MappedStory::PlotLinePlayer
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  PlotLinePlayer(const MappedStory* story,
+                 size_t plot_line,
+                 void* backdrop,
+                 PlayState* state)
+      : story_(story), plot_line_(plot_line), backdrop_(backdrop),
+        state_(state) {
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override;
+  // @}
+
+ private:
+  const MappedStory* story_;
+  size_t plot_line_;
+  void* backdrop_;
+  PlayState* state_;
+
+  DISALLOW_COPY_AND_ASSIGN(PlotLinePlayer);
+};
+
+void MappedStory::PlotLinePlayer::Run() {
+  const MappedPlotLine& plot_line = story_->plot_lines_[plot_line_];
+  PlayFunctor play(backdrop_);
+  for (uint32_t i = 0; i < plot_line.event_count; ++i) {
+    const MappedEvent& event = story_->events_[plot_line.first_event + i];
+    for (uint32_t j = 0; j < event.dep_count; ++j) {
+      if (!WaitForEvent(story_->deps_[event.first_dep + j], state_))
+        return;
+    }
+
+    if (!VisitEvent(event, &play)) {
+      LOG(ERROR) << "Failed to play event " << i << " of plot line "
+                 << plot_line_ << ".";
+      base::subtle::Release_Store(&state_->failed, 1);
+      return;
+    }
+    base::subtle::Release_Store(&state_->played[plot_line_], i + 1);
+  }
+}
+
+MappedStory::MappedStory()
+    : header_(nullptr),
+      heaps_(nullptr),
+      plot_lines_(nullptr),
+      events_(nullptr),
+      deps_(nullptr) {
+}
+
+bool MappedStory::Play(void* backdrop) const {
+  DCHECK_NE(static_cast<const MappedStoryHeader*>(nullptr), header_);
+
+  PlayState state(plot_line_count());
+  ScopedVector<PlotLinePlayer> players;
+  ScopedVector<base::DelegateSimpleThread> threads;
+  for (size_t i = 0; i < plot_line_count(); ++i) {
+    players.push_back(new PlotLinePlayer(this, i, backdrop, &state));
+    threads.push_back(
+        new base::DelegateSimpleThread(players.back(), "PlotLinePlayer"));
+  }
+
+  // A failed plot line stops the others, so the threads can all be joined.
+  for (auto thread : threads)
+    thread->Start();
+  for (auto thread : threads)
+    thread->Join();
+
+  return state.failed == 0;
+}
+
+bool MappedStory::Equals(const Story& story) const {
+  DCHECK_NE(static_cast<const MappedStoryHeader*>(nullptr), header_);
+
+  if (story.plot_lines().size() != plot_line_count())
+    return false;
+
+  LinkedEventIds ids;
+  IndexLinkedEvents(story, &ids);
+
+  for (size_t i = 0; i < plot_line_count(); ++i) {
+    const Story::PlotLine* plot_line = story.plot_lines()[i];
+    const MappedPlotLine& mapped_plot_line = plot_lines_[i];
+    if (plot_line->size() != mapped_plot_line.event_count)
+      return false;
+
+    for (size_t j = 0; j < plot_line->size(); ++j) {
+      const EventInterface* event = (*plot_line)[j];
+      const MappedEvent& record =
+          events_[mapped_plot_line.first_event + j];
+
+      if (event->type() == EventInterface::kLinkedEvent) {
+        const auto* linked = reinterpret_cast<const LinkedEvent*>(event);
+        size_t dep_count = linked->deps().size();
+        if (dep_count != record.dep_count)
+          return false;
+        for (size_t k = 0; k < dep_count; ++k) {
+          auto it = ids.find(linked->deps()[k]);
+          const MappedDep& dep = deps_[record.first_dep + k];
+          if (it == ids.end() || it->second.plot_line != dep.plot_line ||
+              it->second.event != dep.event) {
+            return false;
+          }
+        }
+        event = linked->event();
+      } else if (record.dep_count != 0) {
+        return false;
+      }
+
+      EqualsFunctor equals(event);
+      if (!VisitEvent(record, &equals))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool MappedStory::Init(const uint8_t* data,
+                       size_t size,
+                       const MappedStoryHeader* header) {
+  DCHECK_NE(static_cast<const uint8_t*>(nullptr), data);
+  DCHECK_NE(static_cast<const MappedStoryHeader*>(nullptr), header);
+
+  header_ = header;
+  if (!GetArray(data, size, header->heaps_offset, header->heap_count,
+                &heaps_) ||
+      !GetArray(data, size, header->plot_lines_offset,
+                header->plot_line_count, &plot_lines_) ||
+      !GetArray(data, size, header->events_offset, header->event_count,
+                &events_) ||
+      !GetArray(data, size, header->deps_offset, header->dep_count,
+                &deps_)) {
+    LOG(ERROR) << "The arrays of a mapped story are out of bounds.";
+    return false;
+  }
+
+  // Validate the events up front, so that the playback needn't.
+  for (uint32_t i = 0; i < header->plot_line_count; ++i) {
+    const MappedPlotLine& plot_line = plot_lines_[i];
+    if (static_cast<uint64_t>(plot_line.first_event) + plot_line.event_count >
+        header->event_count) {
+      LOG(ERROR) << "The events of plot line " << i << " are out of bounds.";
+      return false;
+    }
+
+    for (uint32_t j = 0; j < plot_line.event_count; ++j) {
+      const MappedEvent& event = events_[plot_line.first_event + j];
+      if (event.type <= EventInterface::kLinkedEvent ||
+          event.type >= EventInterface::kMaxEventType) {
+        LOG(ERROR) << "Invalid event type " << event.type << ".";
+        return false;
+      }
+      if (static_cast<uint64_t>(event.first_dep) + event.dep_count >
+          header->dep_count) {
+        LOG(ERROR) << "The constraints of an event are out of bounds.";
+        return false;
+      }
+
+      for (uint32_t k = 0; k < event.dep_count; ++k) {
+        const MappedDep& dep = deps_[event.first_dep + k];
+        // An event waiting on itself, or on a later event of its own plot
+        // line, would never be played.
+        if (dep.plot_line >= header->plot_line_count ||
+            dep.event >= plot_lines_[dep.plot_line].event_count ||
+            (dep.plot_line == i && dep.event >= j)) {
+          LOG(ERROR) << "Invalid constraint on event " << j
+                     << " of plot line " << i << ".";
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// static
+bool MappedStoryFile::IsMappedStoryFile(const base::FilePath& path) {
+  MappedStoryFileHeader header = {};
+  int size = static_cast<int>(sizeof(header));
+  if (base::ReadFile(path, reinterpret_cast<char*>(&header), size) != size)
+    return false;
+  return header.magic == MappedStoryFileHeader::kMagic;
+}
+
+bool MappedStoryFile::Open(const base::FilePath& path) {
+  if (!mapped_file_.Initialize(path)) {
+    LOG(ERROR) << "Failed to map \"" << path.value() << "\".";
+    return false;
+  }
+  return Init(mapped_file_.data(), mapped_file_.length());
+}
+
+bool MappedStoryFile::Init(const uint8_t* data, size_t size) {
+  DCHECK_NE(static_cast<const uint8_t*>(nullptr), data);
+
+  stories_.clear();
+  if (size < sizeof(MappedStoryFileHeader))
+    return false;
+  const auto* file_header = reinterpret_cast<const MappedStoryFileHeader*>(
+      data);
+  if (file_header->magic != MappedStoryFileHeader::kMagic ||
+      file_header->version != MappedStoryFileHeader::kVersion) {
+    LOG(ERROR) << "Not a supported file of mapped stories.";
+    return false;
+  }
+
+  const MappedStoryHeader* headers = nullptr;
+  if (!GetArray(data, size, sizeof(MappedStoryFileHeader),
+                file_header->story_count, &headers)) {
+    LOG(ERROR) << "The headers of the mapped stories are out of bounds.";
+    return false;
+  }
+
+  stories_.resize(file_header->story_count);
+  for (uint32_t i = 0; i < file_header->story_count; ++i) {
+    if (!stories_[i].Init(data, size, &headers[i])) {
+      stories_.clear();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace bard
@@ -0,0 +1,214 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a compact, columnar format for stories, which is played straight
+// from a mapped file instead of being deserialized into events first. Each
+// event is a fixed-size record, and its causality constraints are a range of
+// a dependency array. The file is organized as follows:
+//
+// - MappedStoryFileHeader
+// - MappedStoryHeader, for each of the stories
+// - for each of the stories, at the offsets given by its header:
+//   - the heaps that existed when the trace started, as uint64_t. The first
+//     of these is the process heap.
+//   - MappedPlotLine, for each of its plot lines
+//   - MappedEvent, for each of its events, grouped by plot line
+//   - MappedDep, for each of its causality constraints
+//
+// The arrays are all 8-byte aligned. Events are identified by their plot
+// line and their index in it, as in streamed stories. The events of a plot
+// line are played in order, so a constraint is satisfied as soon as its plot
+// line has played past it.
+
+#ifndef SYZYGY_BARD_MAPPED_STORY_H_
+#define SYZYGY_BARD_MAPPED_STORY_H_
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "base/files/memory_mapped_file.h"
+#include "syzygy/bard/story.h"
+
+namespace bard {
+
+// The number of arguments of a mapped event. This is enough for all of the
+// heap events, once their stack trace ID is set aside.
+const size_t kMappedEventArgCount = 5;
+
+struct MappedStoryFileHeader {
+  static const uint32_t kMagic = 0x534D4442;  // 'BDMS'.
+  static const uint32_t kVersion = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t story_count;
+  uint32_t reserved;
+};
+
+// The location of the arrays of a story, as offsets from the start of the
+// file.
+struct MappedStoryHeader {
+  uint64_t heaps_offset;
+  uint64_t plot_lines_offset;
+  uint64_t events_offset;
+  uint64_t deps_offset;
+  uint32_t heap_count;
+  uint32_t plot_line_count;
+  uint32_t event_count;
+  uint32_t dep_count;
+};
+
+// The events of a plot line, as a range of the event array of its story.
+struct MappedPlotLine {
+  uint32_t first_event;
+  uint32_t event_count;
+};
+
+// A fixed-size event record.
+struct MappedEvent {
+  // The EventInterface::EventType of the event. This is never a linked
+  // event, the constraints being given by the dependency range.
+  uint32_t type;
+  uint32_t stack_trace_id;
+  // The causality constraints of the event, as a range of the dependency
+  // array of its story.
+  uint32_t first_dep;
+  uint32_t dep_count;
+  // The arguments of the event, in the order of its constructor.
+  uint64_t args[kMappedEventArgCount];
+};
+
+// An event that must have been played before another one.
+struct MappedDep {
+  uint32_t plot_line;
+  uint32_t event;
+};
+
+// Writes stories in the mapped format.
+class MappedStoryWriter {
+ public:
+  MappedStoryWriter() {}
+
+  // Adds a story to be written.
+  // @param story the story. This must outlive the writer.
+  // @param trace_heaps the heaps that existed when the trace started.
+  // @returns true on success, false if the story has events which can't be
+  //     mapped.
+  bool AddStory(const Story* story, const std::vector<uintptr_t>& trace_heaps);
+
+  // Writes the stories added so far.
+  // @param file the file to write to.
+  // @returns true on success, false otherwise.
+  bool Write(FILE* file) const;
+
+ private:
+  // A story, flattened to the mapped format.
+  struct FlatStory {
+    std::vector<uint64_t> heaps;
+    std::vector<MappedPlotLine> plot_lines;
+    std::vector<MappedEvent> events;
+    std::vector<MappedDep> deps;
+  };
+
+  std::vector<FlatStory> stories_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedStoryWriter);
+};
+
+// A story of a mapped file. This is a view of the file, which must outlive
+// it.
+class MappedStory {
+ public:
+  MappedStory();
+
+  // @returns the heaps that existed when the trace started. The first of
+  //     these is the process heap.
+  const uint64_t* heaps() const { return heaps_; }
+  size_t heap_count() const { return header_->heap_count; }
+
+  // @returns the number of plot lines of this story.
+  size_t plot_line_count() const { return header_->plot_line_count; }
+
+  // @returns the total number of events of this story.
+  size_t event_count() const { return header_->event_count; }
+
+  // Plays this story against the provided backdrop. Spins up a thread per
+  // plot line, and plays the events back as fast as possible on each
+  // thread. Unlike Story::Play, the other plot lines give up after an event
+  // fails, and all the threads are joined.
+  // @returns true on success, false otherwise.
+  bool Play(void* backdrop) const;
+
+  // For unittesting.
+  bool Equals(const Story& story) const;
+
+ private:
+  friend class MappedStoryFile;
+
+  // Plays the plot lines of a story.
+  class PlotLinePlayer;
+
+  // Validates and sets up this view of a story.
+  // @param data the mapped file.
+  // @param size the size of @p data.
+  // @param header the header of this story.
+  // @returns true on success, false if the file is malformed.
+  bool Init(const uint8_t* data,
+            size_t size,
+            const MappedStoryHeader* header);
+
+  const MappedStoryHeader* header_;
+  const uint64_t* heaps_;
+  const MappedPlotLine* plot_lines_;
+  const MappedEvent* events_;
+  const MappedDep* deps_;
+};
+
+// A file of mapped stories.
+class MappedStoryFile {
+ public:
+  MappedStoryFile() {}
+
+  // @returns true if @p path starts like a file of mapped stories.
+  static bool IsMappedStoryFile(const base::FilePath& path);
+
+  // Maps a file of stories, and validates it.
+  // @param path the path of the file.
+  // @returns true on success, false otherwise.
+  bool Open(const base::FilePath& path);
+
+  // Sets up a file of stories that is already in memory, and validates it.
+  // @param data the contents of the file. These must outlive this object.
+  // @param size the size of @p data.
+  // @returns true on success, false otherwise.
+  bool Init(const uint8_t* data, size_t size);
+
+  // @name Accessors.
+  // @{
+  const std::vector<MappedStory>& stories() const { return stories_; }
+  // @}
+
+ private:
+  base::MemoryMappedFile mapped_file_;
+  std::vector<MappedStory> stories_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedStoryFile);
+};
+
+}  // namespace bard
+
+#endif  // SYZYGY_BARD_MAPPED_STORY_H_
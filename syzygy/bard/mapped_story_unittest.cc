@@ -0,0 +1,247 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/bard/mapped_story.h"
+
+#include "base/bind.h"
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "gtest/gtest.h"
+#include "syzygy/bard/backdrops/heap_backdrop.h"
+#include "syzygy/bard/events/heap_alloc_event.h"
+#include "syzygy/bard/events/heap_create_event.h"
+#include "syzygy/bard/events/heap_destroy_event.h"
+#include "syzygy/bard/events/heap_free_event.h"
+#include "syzygy/bard/events/heap_size_event.h"
+#include "syzygy/bard/events/linked_event.h"
+
+namespace bard {
+
+namespace {
+
+using backdrops::HeapBackdrop;
+using events::HeapAllocEvent;
+using events::HeapCreateEvent;
+using events::HeapDestroyEvent;
+using events::HeapFreeEvent;
+using events::HeapSizeEvent;
+using events::LinkedEvent;
+
+const HANDLE kLiveHeap = reinterpret_cast<HANDLE>(0x4197FC83);
+const HANDLE kTraceHeap = reinterpret_cast<HANDLE>(0xAB12CD34);
+const HANDLE kTraceProcessHeap = reinterpret_cast<HANDLE>(0x12345678);
+const LPVOID kLiveAlloc = reinterpret_cast<LPVOID>(0x4820BC7A);
+const LPVOID kTraceAlloc = reinterpret_cast<LPVOID>(0xF1D97AE4);
+const DWORD kFlags = 1;
+const DWORD kOptions = 0;
+const SIZE_T kBytes = 100;
+const SIZE_T kInitialSize = 1;
+const SIZE_T kMaximumSize = 1000;
+
+// @name Fake heap API functions, playing the story built by BuildStory.
+// @{
+LPVOID FakeHeapAlloc(HANDLE heap, DWORD flags, SIZE_T bytes) {
+  return heap == kLiveHeap ? kLiveAlloc : nullptr;
+}
+
+HANDLE FakeHeapCreate(DWORD options, SIZE_T initial_size, SIZE_T max_size) {
+  return kLiveHeap;
+}
+
+BOOL FakeHeapDestroy(HANDLE heap) {
+  return heap == kLiveHeap;
+}
+
+BOOL FakeHeapFree(HANDLE heap, DWORD flags, LPVOID mem) {
+  return heap == kLiveHeap && mem == kLiveAlloc;
+}
+
+SIZE_T FakeHeapSize(HANDLE heap, DWORD flags, LPCVOID mem) {
+  return kBytes;
+}
+// @}
+
+// Builds a story of two plot lines. The first one creates and destroys a
+// heap, and the second one uses an allocation of that heap in the meantime.
+void BuildStory(HANDLE alloc_heap, Story* story) {
+  std::unique_ptr<LinkedEvent> create(new LinkedEvent(
+      std::unique_ptr<EventInterface>(new HeapCreateEvent(
+          1, kOptions, kInitialSize, kMaximumSize, kTraceHeap))));
+  std::unique_ptr<LinkedEvent> alloc(new LinkedEvent(
+      std::unique_ptr<EventInterface>(new HeapAllocEvent(
+          2, alloc_heap, kFlags, kBytes, kTraceAlloc))));
+  std::unique_ptr<EventInterface> size(
+      new HeapSizeEvent(3, kTraceHeap, kFlags, kTraceAlloc, kBytes));
+  std::unique_ptr<LinkedEvent> free(new LinkedEvent(
+      std::unique_ptr<EventInterface>(new HeapFreeEvent(
+          4, kTraceHeap, kFlags, kTraceAlloc, true))));
+  std::unique_ptr<LinkedEvent> destroy(new LinkedEvent(
+      std::unique_ptr<EventInterface>(new HeapDestroyEvent(
+          5, kTraceHeap, true))));
+
+  alloc->AddDep(create.get());
+  destroy->AddDep(free.get());
+
+  Story::PlotLine* plot_line1 = story->CreatePlotLine();
+  plot_line1->push_back(create.release());
+  plot_line1->push_back(destroy.release());
+
+  Story::PlotLine* plot_line2 = story->CreatePlotLine();
+  plot_line2->push_back(alloc.release());
+  plot_line2->push_back(size.release());
+  plot_line2->push_back(free.release());
+}
+
+class MappedStoryTest : public testing::Test {
+ public:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    path_ = temp_dir_.path().Append(L"stories.bin");
+
+    backdrop_.set_heap_alloc(base::Bind(&FakeHeapAlloc));
+    backdrop_.set_heap_create(base::Bind(&FakeHeapCreate));
+    backdrop_.set_heap_destroy(base::Bind(&FakeHeapDestroy));
+    backdrop_.set_heap_free(base::Bind(&FakeHeapFree));
+    backdrop_.set_heap_size(base::Bind(&FakeHeapSize));
+  }
+
+  // Writes the stories of a writer to path_.
+  void WriteStories(const MappedStoryWriter& writer) {
+    base::ScopedFILE file(base::OpenFile(path_, "wb"));
+    ASSERT_TRUE(file.get() != nullptr);
+    ASSERT_TRUE(writer.Write(file.get()));
+  }
+
+  // Reads back path_.
+  void ReadFile(std::string* contents) {
+    ASSERT_TRUE(base::ReadFileToString(path_, contents));
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath path_;
+  HeapBackdrop backdrop_;
+};
+
+}  // namespace
+
+TEST_F(MappedStoryTest, RoundTrip) {
+  Story story1;
+  BuildStory(kTraceHeap, &story1);
+  Story story2;
+  story2.CreatePlotLine()->push_back(
+      new HeapAllocEvent(6, kTraceProcessHeap, 0, 10, kTraceAlloc));
+
+  std::vector<uintptr_t> heaps1;
+  std::vector<uintptr_t> heaps2(
+      1, reinterpret_cast<uintptr_t>(kTraceProcessHeap));
+  MappedStoryWriter writer;
+  ASSERT_TRUE(writer.AddStory(&story1, heaps1));
+  ASSERT_TRUE(writer.AddStory(&story2, heaps2));
+  ASSERT_NO_FATAL_FAILURE(WriteStories(writer));
+
+  EXPECT_TRUE(MappedStoryFile::IsMappedStoryFile(path_));
+  MappedStoryFile file;
+  ASSERT_TRUE(file.Open(path_));
+  ASSERT_EQ(2u, file.stories().size());
+
+  const MappedStory& mapped1 = file.stories()[0];
+  EXPECT_EQ(0u, mapped1.heap_count());
+  EXPECT_EQ(2u, mapped1.plot_line_count());
+  EXPECT_EQ(5u, mapped1.event_count());
+  EXPECT_TRUE(mapped1.Equals(story1));
+  EXPECT_FALSE(mapped1.Equals(story2));
+
+  const MappedStory& mapped2 = file.stories()[1];
+  ASSERT_EQ(1u, mapped2.heap_count());
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(kTraceProcessHeap),
+            mapped2.heaps()[0]);
+  EXPECT_TRUE(mapped2.Equals(story2));
+}
+
+TEST_F(MappedStoryTest, Play) {
+  Story story;
+  BuildStory(kTraceHeap, &story);
+  MappedStoryWriter writer;
+  ASSERT_TRUE(writer.AddStory(&story, std::vector<uintptr_t>()));
+  ASSERT_NO_FATAL_FAILURE(WriteStories(writer));
+
+  MappedStoryFile file;
+  ASSERT_TRUE(file.Open(path_));
+  ASSERT_EQ(1u, file.stories().size());
+  EXPECT_TRUE(file.stories()[0].Play(&backdrop_));
+
+  // Everything was freed and destroyed.
+  EXPECT_TRUE(backdrop_.heap_map().Empty());
+  EXPECT_TRUE(backdrop_.alloc_map().Empty());
+}
+
+TEST_F(MappedStoryTest, PlaybackStopsAndFails) {
+  // The allocation is made from a heap that doesn't exist. The other plot
+  // line waits on the free of that allocation, and must give up.
+  Story story;
+  BuildStory(kTraceProcessHeap, &story);
+  MappedStoryWriter writer;
+  ASSERT_TRUE(writer.AddStory(&story, std::vector<uintptr_t>()));
+  ASSERT_NO_FATAL_FAILURE(WriteStories(writer));
+
+  MappedStoryFile file;
+  ASSERT_TRUE(file.Open(path_));
+  ASSERT_EQ(1u, file.stories().size());
+  EXPECT_FALSE(file.stories()[0].Play(&backdrop_));
+  EXPECT_TRUE(backdrop_.TearDown());
+}
+
+TEST_F(MappedStoryTest, RejectsMalformedFiles) {
+  Story story;
+  BuildStory(kTraceHeap, &story);
+  MappedStoryWriter writer;
+  ASSERT_TRUE(writer.AddStory(&story, std::vector<uintptr_t>()));
+  ASSERT_NO_FATAL_FAILURE(WriteStories(writer));
+  std::string contents;
+  ASSERT_NO_FATAL_FAILURE(ReadFile(&contents));
+
+  MappedStoryFile file;
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(contents.data());
+  ASSERT_TRUE(file.Init(data, contents.size()));
+
+  // Truncated files.
+  EXPECT_FALSE(file.Init(data, sizeof(MappedStoryFileHeader) - 1));
+  EXPECT_FALSE(file.Init(data, contents.size() - 1));
+  EXPECT_TRUE(file.stories().empty());
+
+  // An unknown version.
+  std::string bad_version(contents);
+  reinterpret_cast<MappedStoryFileHeader*>(&bad_version[0])->version += 1;
+  EXPECT_FALSE(file.Init(reinterpret_cast<const uint8_t*>(bad_version.data()),
+                         bad_version.size()));
+
+  // An event waiting on itself. The last array of the file is the dependency
+  // array, whose first entry is the constraint of the destruction of the heap
+  // on the free.
+  std::string bad_dep(contents);
+  MappedDep* deps = reinterpret_cast<MappedDep*>(
+      &bad_dep[bad_dep.size() - 2 * sizeof(MappedDep)]);
+  deps[0].plot_line = 0;
+  deps[0].event = 1;
+  EXPECT_FALSE(file.Init(reinterpret_cast<const uint8_t*>(bad_dep.data()),
+                         bad_dep.size()));
+}
+
+TEST_F(MappedStoryTest, IsMappedStoryFile) {
+  EXPECT_FALSE(MappedStoryFile::IsMappedStoryFile(path_));
+  ASSERT_EQ(5, base::WriteFile(path_, "hello", 5));
+  EXPECT_FALSE(MappedStoryFile::IsMappedStoryFile(path_));
+}
+
+}  // namespace bard
@@ -151,6 +151,97 @@ bool Story::Load(core::InArchive* in_archive) {
   return true;
 }
 
+// static
+bool Story::SaveChunk(const ScopedVector<PlotLine>& plot_lines,
+                      const ChunkDeps& deps,
+                      core::OutArchive* out_archive) {
+  DCHECK_NE(static_cast<core::OutArchive*>(nullptr), out_archive);
+
+  // Save the new events of each plot line.
+  if (!out_archive->Save(plot_lines.size()))
+    return false;
+  for (const PlotLine* plot_line : plot_lines) {
+    if (!out_archive->Save(plot_line->size()))
+      return false;
+
+    for (const EventInterface* event : *plot_line) {
+      DCHECK_NE(EventInterface::kLinkedEvent, event->type());
+      if (!EventInterface::Save(event, out_archive))
+        return false;
+    }
+  }
+
+  // Save the causality constraints.
+  if (!out_archive->Save(deps.size()))
+    return false;
+  for (const ChunkDep& dep : deps) {
+    if (!out_archive->Save(dep.first.first) ||
+        !out_archive->Save(dep.first.second) ||
+        !out_archive->Save(dep.second.first) ||
+        !out_archive->Save(dep.second.second)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Story::LoadChunk(core::InArchive* in_archive) {
+  DCHECK_NE(static_cast<core::InArchive*>(nullptr), in_archive);
+
+  // Plot lines are only ever added to a story.
+  size_t plot_line_count = 0;
+  if (!in_archive->Load(&plot_line_count))
+    return false;
+  if (plot_line_count < plot_lines_.size()) {
+    LOG(ERROR) << "Story chunk has fewer plot lines than the story.";
+    return false;
+  }
+  while (plot_lines_.size() < plot_line_count)
+    CreatePlotLine();
+
+  // Append the new events to each plot line.
+  for (PlotLine* plot_line : plot_lines_) {
+    size_t event_count = 0;
+    if (!in_archive->Load(&event_count))
+      return false;
+    for (size_t i = 0; i < event_count; ++i) {
+      std::unique_ptr<EventInterface> event = EventInterface::Load(in_archive);
+      if (!event.get())
+        return false;
+      if (event->type() == EventInterface::kLinkedEvent) {
+        LOG(ERROR) << "Story chunk contains a linked event.";
+        return false;
+      }
+      plot_line->push_back(event.release());
+    }
+  }
+
+  // Wire up the causality constraints.
+  size_t dep_count = 0;
+  if (!in_archive->Load(&dep_count))
+    return false;
+  for (size_t i = 0; i < dep_count; ++i) {
+    ChunkDep dep;
+    if (!in_archive->Load(&dep.first.first) ||
+        !in_archive->Load(&dep.first.second) ||
+        !in_archive->Load(&dep.second.first) ||
+        !in_archive->Load(&dep.second.second)) {
+      return false;
+    }
+
+    LinkedEvent* event = GetLinkedEvent(dep.first);
+    LinkedEvent* input = GetLinkedEvent(dep.second);
+    if (event == nullptr || input == nullptr) {
+      LOG(ERROR) << "Story chunk constraint refers to a missing event.";
+      return false;
+    }
+    event->AddDep(input);
+  }
+
+  return true;
+}
+
 namespace {
 
 struct RunnerInfo {
@@ -194,22 +285,22 @@ bool Story::Play(void* backdrop) {
     runner->Start();
 
   // Wait for all threads to finish successfully, or for one to fail.
-  bool success = true;
-  while (true) {
-    // Wait for at least one runner to complete.
+  // The conditions are checked before waiting, as all of the runners may
+  // already have completed, in which case no signal is coming.
+  {
     base::AutoLock auto_lock(info.lock);
-    info.cv.Wait();
-
-    if (info.failed) {
-      success = false;
-      break;
-    }
-
-    if (info.completed_count == runners.size())
-      break;
+    while (!info.failed && info.completed_count < runners.size())
+      info.cv.Wait();
+    if (info.failed)
+      return false;
   }
 
-  return success;
+  // Every runner has completed, so this doesn't block for long. It ensures
+  // that none of them is still using |info| once it goes out of scope.
+  for (auto runner : runners)
+    runner->Join();
+
+  return true;
 }
 
 bool Story::operator==(const Story& story) const {
@@ -222,6 +313,21 @@ bool Story::operator==(const Story& story) const {
   return true;
 }
 
+LinkedEvent* Story::GetLinkedEvent(const EventId& id) {
+  if (id.first >= plot_lines_.size())
+    return nullptr;
+  PlotLine* plot_line = plot_lines_[id.first];
+  if (id.second >= plot_line->size())
+    return nullptr;
+
+  EventInterface* event = (*plot_line)[id.second];
+  if (event->type() != EventInterface::kLinkedEvent) {
+    event = new LinkedEvent(std::unique_ptr<EventInterface>(event));
+    (*plot_line)[id.second] = event;
+  }
+  return reinterpret_cast<LinkedEvent*>(event);
+}
+
 Story::PlotLineRunner::PlotLineRunner(void* backdrop, PlotLine* plot_line)
     : backdrop_(backdrop),
       plot_line_(plot_line),
@@ -34,10 +34,30 @@
 //   - number of input constraints
 //   - (linked event id) of input constraint 0
 //   - ... repeated for other constraints ...
+//
+// A story can also be streamed as a sequence of chunks, each written by
+// SaveChunk and appended to the story by LoadChunk:
+//
+// - number of plot lines so far
+// - PlotLine0
+//   - number of events appended to plot line 0 by this chunk
+//   - Event0 ... (as above, but never a linked event)
+// - ... repeated for other plot lines ...
+// - number of causality constraints
+//   - (plot line, index) of event with an input constraint
+//   - (plot line, index) of the input constraint
+//   - ... repeated for other constraints ...
+//
+// Events are identified by their plot line and their index in it, so that a
+// constraint may refer to an event of an earlier chunk. The events that take
+// part in constraints are turned into linked events as the chunks are loaded.
 
 #ifndef SYZYGY_BARD_STORY_H_
 #define SYZYGY_BARD_STORY_H_
 
+#include <utility>
+#include <vector>
+
 #include "base/callback.h"
 #include "base/memory/scoped_vector.h"
 #include "base/threading/simple_thread.h"
@@ -46,6 +66,10 @@
 
 namespace bard {
 
+namespace events {
+class LinkedEvent;
+}  // namespace events
+
 // Container class for storing and serializing PlotLines.
 class Story {
  public:
@@ -60,6 +84,16 @@ class Story {
   // Some constants used in serialization.
   static const uint32_t kBardMagic = 0xBA4D7355;
   static const uint32_t kBardVersion = 1;
+  // The version of the streams of story chunks.
+  static const uint32_t kBardChunkedVersion = 2;
+
+  // Identifies an event of a story by the index of its plot line and its
+  // index in that plot line.
+  using EventId = std::pair<size_t, size_t>;
+  // A causality constraint between two events of a streamed story. The
+  // first event waits on the second.
+  using ChunkDep = std::pair<EventId, EventId>;
+  using ChunkDeps = std::vector<ChunkDep>;
 
   Story() {}
 
@@ -79,6 +113,25 @@ class Story {
   bool Load(core::InArchive* in_archive);
   // @}
 
+  // @name Chunked serialization methods.
+  // @{
+  // Serializes a chunk of a story being streamed.
+  // @param plot_lines the events appended to each plot line of the story
+  //     since the previous chunk. These must not be linked events.
+  // @param deps the causality constraints of the events of @p plot_lines.
+  //     Their inputs may be events of earlier chunks.
+  // @param out_archive the archive to serialize to.
+  // @returns true on success, false otherwise.
+  static bool SaveChunk(const ScopedVector<PlotLine>& plot_lines,
+                        const ChunkDeps& deps,
+                        core::OutArchive* out_archive);
+  // Deserializes a chunk written by SaveChunk, appending its events to this
+  // story.
+  // @param in_archive the archive to deserialize from.
+  // @returns true on success, false otherwise.
+  bool LoadChunk(core::InArchive* in_archive);
+  // @}
+
   // Accessor for unittesting.
   const ScopedVector<PlotLine>& plot_lines() const { return plot_lines_; }
 
@@ -90,6 +143,11 @@ class Story {
   bool operator==(const Story& story) const;
 
  private:
+  // Turns an event into a linked event, if it isn't one already.
+  // @param id the event to look up.
+  // @returns the linked event, or nullptr if @p id is not a valid event.
+  events::LinkedEvent* GetLinkedEvent(const EventId& id);
+
   ScopedVector<PlotLine> plot_lines_;
 
   DISALLOW_COPY_AND_ASSIGN(Story);
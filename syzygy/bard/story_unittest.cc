@@ -165,6 +165,81 @@ TEST(StoryTest, TestSerialization) {
   EXPECT_TRUE(testing::TestSerialization(story));
 }
 
+TEST(StoryTest, TestChunkedSerialization) {
+  core::ByteVector bytes;
+  core::ScopedOutStreamPtr out_stream;
+  out_stream.reset(core::CreateByteOutStream(std::back_inserter(bytes)));
+  core::NativeBinaryOutArchive out_archive(out_stream.get());
+
+  // The first chunk creates the heap on one plot line, and allocates from it
+  // on another.
+  ScopedVector<Story::PlotLine> chunk1;
+  chunk1.push_back(new Story::PlotLine());
+  chunk1.push_back(new Story::PlotLine());
+  chunk1[0]->push_back(
+      new HeapCreateEvent(0, kOptions, kInitialSize, kMaximumSize, kTraceHeap));
+  chunk1[1]->push_back(
+      new HeapAllocEvent(0, kTraceHeap, kFlags, kBytes, kTraceAlloc));
+  Story::ChunkDeps deps1;
+  deps1.push_back(Story::ChunkDep(Story::EventId(1, 0), Story::EventId(0, 0)));
+  EXPECT_TRUE(Story::SaveChunk(chunk1, deps1, &out_archive));
+
+  // The second chunk frees the allocation and destroys the heap, which
+  // depends on an event of the same chunk.
+  ScopedVector<Story::PlotLine> chunk2;
+  chunk2.push_back(new Story::PlotLine());
+  chunk2.push_back(new Story::PlotLine());
+  chunk2[0]->push_back(new HeapDestroyEvent(0, kTraceHeap, true));
+  chunk2[1]->push_back(
+      new HeapSizeEvent(0, kTraceHeap, kFlags, kTraceAlloc, kSize));
+  chunk2[1]->push_back(
+      new HeapFreeEvent(0, kTraceHeap, kFlags, kTraceAlloc, true));
+  Story::ChunkDeps deps2;
+  deps2.push_back(Story::ChunkDep(Story::EventId(0, 1), Story::EventId(1, 2)));
+  EXPECT_TRUE(Story::SaveChunk(chunk2, deps2, &out_archive));
+
+  // A chunk referring to a missing event.
+  ScopedVector<Story::PlotLine> chunk3;
+  chunk3.push_back(new Story::PlotLine());
+  Story::ChunkDeps deps3;
+  deps3.push_back(Story::ChunkDep(Story::EventId(0, 0), Story::EventId(5, 0)));
+  EXPECT_TRUE(Story::SaveChunk(chunk3, deps3, &out_archive));
+  ASSERT_TRUE(out_archive.Flush());
+
+  core::ScopedInStreamPtr in_stream;
+  in_stream.reset(core::CreateByteInStream(bytes.begin(), bytes.end()));
+  core::NativeBinaryInArchive in_archive(in_stream.get());
+  Story story;
+  EXPECT_TRUE(story.LoadChunk(&in_archive));
+  EXPECT_TRUE(story.LoadChunk(&in_archive));
+
+  // The events taking part in constraints are now linked events.
+  ASSERT_EQ(2u, story.plot_lines().size());
+  const Story::PlotLine& plot_line1 = *story.plot_lines()[0];
+  const Story::PlotLine& plot_line2 = *story.plot_lines()[1];
+  ASSERT_EQ(2u, plot_line1.size());
+  ASSERT_EQ(3u, plot_line2.size());
+  EXPECT_EQ(EventInterface::kLinkedEvent, plot_line1[0]->type());
+  EXPECT_EQ(EventInterface::kLinkedEvent, plot_line1[1]->type());
+  EXPECT_EQ(EventInterface::kLinkedEvent, plot_line2[0]->type());
+  EXPECT_EQ(EventInterface::kHeapSizeEvent, plot_line2[1]->type());
+  EXPECT_EQ(EventInterface::kLinkedEvent, plot_line2[2]->type());
+
+  const LinkedEvent* alloc =
+      reinterpret_cast<const LinkedEvent*>(plot_line2[0]);
+  ASSERT_EQ(1u, alloc->deps().size());
+  EXPECT_EQ(plot_line1[0], alloc->deps().front());
+  const LinkedEvent* destroy =
+      reinterpret_cast<const LinkedEvent*>(plot_line1[1]);
+  ASSERT_EQ(1u, destroy->deps().size());
+  EXPECT_EQ(plot_line2[2], destroy->deps().front());
+
+  // The loaded story serializes like any other.
+  EXPECT_TRUE(testing::TestSerialization(story));
+
+  EXPECT_FALSE(story.LoadChunk(&in_archive));
+}
+
 TEST(PlotLineRunnerTest, StopOnFailedEvent) {
   Story::PlotLine plot_line;
   plot_line.push_back(new AppendEvent(0));
@@ -18,7 +18,9 @@
 #define SYZYGY_BARD_TRACE_LIVE_MAP_H_
 
 #include <map>
+#include <unordered_map>
 
+#include "base/macros.h"
 #include "base/synchronization/lock.h"
 
 namespace bard {
@@ -27,12 +29,18 @@ namespace bard {
 // from trace file pointers to live pointers, since the addresses for the
 // live ones are not the same.
 // This class is thread safe for simultaneous access accross multiple threads.
+// Each direction of the map is split into shards by the hash of the pointer,
+// each with a lock of its own, so that the plot lines of a story being played
+// seldom contend for the same lock.
 // @tparam T The type of object that the class is mapping.
 template <typename T>
 class TraceLiveMap {
  public:
   using Map = std::map<T, T>;
 
+  // The number of shards of each direction of the map.
+  static const size_t kShardCount = 16;
+
   bool AddMapping(T trace, T live);
   bool RemoveMapping(T trace, T live);
 
@@ -43,19 +51,44 @@ class TraceLiveMap {
   void Clear();
 
   // @returns true iff this map is empty.
-  bool Empty() const { return trace_live_.empty() && live_trace_.empty(); }
+  bool Empty() const;
 
-  // @name Simple accessors.
+  // @name Snapshots of the mappings, merging the shards. These are not
+  //     consistent with concurrent modifications of the map.
   // @{
-  const Map& trace_live() const { return trace_live_; }
-  const Map& live_trace() const { return live_trace_; }
+  Map trace_live() const;
+  Map live_trace() const;
   // @}
 
  private:
-  Map trace_live_;
-  Map live_trace_;
+  // A shard of one direction of the map.
+  struct Shard {
+    mutable base::Lock lock;
+    std::unordered_map<T, T> map;
+  };
+
+  // @returns the shard of @p key in @p shards.
+  static Shard& GetShard(Shard* shards, T key);
+
+  // Inserts @p key and @p value in their shard of @p shards.
+  // @returns false if @p key is already present.
+  static bool Insert(Shard* shards, T key, T value);
+
+  // Erases @p key from its shard of @p shards.
+  // @returns false if @p key is not present.
+  static bool Erase(Shard* shards, T key);
+
+  // Looks up @p key in its shard of @p shards.
+  // @returns false if @p key is not present.
+  static bool Find(Shard* shards, T key, T* value);
+
+  // Merges the shards of a direction of the map into @p map.
+  static void Merge(const Shard* shards, Map* map);
+
+  Shard trace_live_[kShardCount];
+  Shard live_trace_[kShardCount];
 
-  base::Lock lock_;
+  DISALLOW_COPY_AND_ASSIGN(TraceLiveMap);
 };
 
 }  // namespace bard
@@ -25,20 +25,17 @@ bool TraceLiveMap<T>::AddMapping(T trace, T live) {
   if (trace == nullptr && live == nullptr)
     return true;
 
-  base::AutoLock auto_lock(lock_);
-
-  auto insert_trace_live = trace_live_.insert(std::make_pair(trace, live));
-
-  if (!insert_trace_live.second) {
+  // The two directions are updated under distinct locks, as taking both
+  // would have the shards contend again. A mapping is only ever played by a
+  // single plot line, so this doesn't race in a consistent story.
+  if (!Insert(trace_live_, trace, live)) {
     LOG(ERROR) << "Trace argument was previously added: " << trace;
     return false;
   }
 
-  auto insert_live_trace = live_trace_.insert(std::make_pair(live, trace));
-
-  if (!insert_live_trace.second) {
+  if (!Insert(live_trace_, live, trace)) {
     LOG(ERROR) << "Live argument was previously added: " << live;
-    trace_live_.erase(insert_trace_live.first);
+    Erase(trace_live_, trace);
     return false;
   }
 
@@ -51,23 +48,19 @@ bool TraceLiveMap<T>::RemoveMapping(T trace, T live) {
   if (trace == nullptr && live == nullptr)
     return true;
 
-  base::AutoLock auto_lock(lock_);
-
-  auto find_trace_live = trace_live_.find(trace);
-  auto find_live_trace = live_trace_.find(live);
-
-  if (find_trace_live == trace_live_.end()) {
+  T found = nullptr;
+  if (!Find(trace_live_, trace, &found)) {
     LOG(ERROR) << "Trace was not previously added:" << trace;
     return false;
   }
 
-  if (find_live_trace == live_trace_.end()) {
+  if (!Find(live_trace_, live, &found)) {
     LOG(ERROR) << "Live was not previously added: " << live;
     return false;
   }
 
-  trace_live_.erase(find_trace_live);
-  live_trace_.erase(find_live_trace);
+  Erase(trace_live_, trace);
+  Erase(live_trace_, live);
   return true;
 }
 
@@ -79,15 +72,11 @@ bool TraceLiveMap<T>::GetLiveFromTrace(T trace, T* live) {
     return true;
   }
 
-  base::AutoLock auto_lock(lock_);
-
-  auto live_it = trace_live_.find(trace);
-  if (live_it == trace_live_.end()) {
+  if (!Find(trace_live_, trace, live)) {
     LOG(ERROR) << "Trace argument was not previously added: " << trace;
     return false;
   }
 
-  *live = live_it->second;
   return true;
 }
 
@@ -99,22 +88,103 @@ bool TraceLiveMap<T>::GetTraceFromLive(T live, T* trace) {
     return true;
   }
 
-  base::AutoLock auto_lock(lock_);
-
-  auto trace_it = live_trace_.find(live);
-  if (trace_it == live_trace_.end()) {
+  if (!Find(live_trace_, live, trace)) {
     LOG(ERROR) << "Live argument was not previously added: " << live;
     return false;
   }
 
-  *trace = trace_it->second;
   return true;
 }
 
 template <typename T>
 void TraceLiveMap<T>::Clear() {
-  trace_live_.clear();
-  live_trace_.clear();
+  for (size_t i = 0; i < kShardCount; ++i) {
+    {
+      base::AutoLock auto_lock(trace_live_[i].lock);
+      trace_live_[i].map.clear();
+    }
+    base::AutoLock auto_lock(live_trace_[i].lock);
+    live_trace_[i].map.clear();
+  }
+}
+
+template <typename T>
+bool TraceLiveMap<T>::Empty() const {
+  for (size_t i = 0; i < kShardCount; ++i) {
+    {
+      base::AutoLock auto_lock(trace_live_[i].lock);
+      if (!trace_live_[i].map.empty())
+        return false;
+    }
+    base::AutoLock auto_lock(live_trace_[i].lock);
+    if (!live_trace_[i].map.empty())
+      return false;
+  }
+  return true;
+}
+
+template <typename T>
+typename TraceLiveMap<T>::Map TraceLiveMap<T>::trace_live() const {
+  Map map;
+  Merge(trace_live_, &map);
+  return map;
+}
+
+template <typename T>
+typename TraceLiveMap<T>::Map TraceLiveMap<T>::live_trace() const {
+  Map map;
+  Merge(live_trace_, &map);
+  return map;
+}
+
+// static
+template <typename T>
+typename TraceLiveMap<T>::Shard& TraceLiveMap<T>::GetShard(Shard* shards,
+                                                           T key) {
+  // The low bits of heap addresses are mostly alignment, so fold in some
+  // higher ones.
+  uintptr_t bits = reinterpret_cast<uintptr_t>(key);
+  bits = (bits >> 4) ^ (bits >> 12) ^ (bits >> 20);
+  return shards[bits % kShardCount];
+}
+
+// static
+template <typename T>
+bool TraceLiveMap<T>::Insert(Shard* shards, T key, T value) {
+  Shard& shard = GetShard(shards, key);
+  base::AutoLock auto_lock(shard.lock);
+  return shard.map.insert(std::make_pair(key, value)).second;
+}
+
+// static
+template <typename T>
+bool TraceLiveMap<T>::Erase(Shard* shards, T key) {
+  Shard& shard = GetShard(shards, key);
+  base::AutoLock auto_lock(shard.lock);
+  return shard.map.erase(key) != 0;
+}
+
+// static
+template <typename T>
+bool TraceLiveMap<T>::Find(Shard* shards, T key, T* value) {
+  DCHECK_NE(static_cast<T*>(nullptr), value);
+  Shard& shard = GetShard(shards, key);
+  base::AutoLock auto_lock(shard.lock);
+  auto it = shard.map.find(key);
+  if (it == shard.map.end())
+    return false;
+  *value = it->second;
+  return true;
+}
+
+// static
+template <typename T>
+void TraceLiveMap<T>::Merge(const Shard* shards, Map* map) {
+  DCHECK_NE(static_cast<Map*>(nullptr), map);
+  for (size_t i = 0; i < kShardCount; ++i) {
+    base::AutoLock auto_lock(shards[i].lock);
+    map->insert(shards[i].map.begin(), shards[i].map.end());
+  }
 }
 
 }  // namespace bard
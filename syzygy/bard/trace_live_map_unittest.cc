@@ -14,11 +14,59 @@
 
 #include "syzygy/bard/trace_live_map.h"
 
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 #include "syzygy/bard/unittest_util.h"
 
 namespace bard {
 
+namespace {
+
+// The number of mappings added by each thread of the concurrency test.
+const size_t kMappingsPerThread = 1000;
+
+// Adds, checks and removes a range of mappings of its own.
+class MappingRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  MappingRunner(TraceLiveMap<void*>* trace_live_map, uintptr_t first)
+      : trace_live_map_(trace_live_map), first_(first), success_(false) {}
+
+  void Run() override {
+    for (size_t i = 0; i < kMappingsPerThread; ++i) {
+      if (!trace_live_map_->AddMapping(Trace(i), Live(i)))
+        return;
+    }
+    for (size_t i = 0; i < kMappingsPerThread; ++i) {
+      void* live = nullptr;
+      void* trace = nullptr;
+      if (!trace_live_map_->GetLiveFromTrace(Trace(i), &live) ||
+          live != Live(i) ||
+          !trace_live_map_->GetTraceFromLive(Live(i), &trace) ||
+          trace != Trace(i) ||
+          !trace_live_map_->RemoveMapping(Trace(i), Live(i))) {
+        return;
+      }
+    }
+    success_ = true;
+  }
+
+  bool success() const { return success_; }
+
+ private:
+  void* Trace(size_t i) const {
+    return reinterpret_cast<void*>((first_ + i) * 16);
+  }
+  void* Live(size_t i) const {
+    return reinterpret_cast<void*>((first_ + i) * 16 + 8);
+  }
+
+  TraceLiveMap<void*>* trace_live_map_;
+  uintptr_t first_;
+  bool success_;
+};
+
+}  // namespace
+
 TEST(TraceLiveMapTest, TestMapping) {
   TraceLiveMap<void*> trace_live_map;
   EXPECT_TRUE(trace_live_map.Empty());
@@ -32,6 +80,9 @@ TEST(TraceLiveMapTest, TestMapping) {
   EXPECT_FALSE(trace_live_map.AddMapping(trace, extra_live));
   EXPECT_FALSE(trace_live_map.AddMapping(extra_trace, live));
   testing::CheckTraceLiveMapContains(trace_live_map, trace, live);
+  void* found = nullptr;
+  EXPECT_FALSE(trace_live_map.GetLiveFromTrace(extra_trace, &found));
+  EXPECT_FALSE(trace_live_map.GetTraceFromLive(extra_live, &found));
   EXPECT_FALSE(trace_live_map.Empty());
 
   EXPECT_TRUE(trace_live_map.RemoveMapping(trace, live));
@@ -45,4 +96,47 @@ TEST(TraceLiveMapTest, TestMapping) {
   testing::CheckTraceLiveMapNotContain(trace_live_map, trace, live);
 }
 
+TEST(TraceLiveMapTest, TestSnapshots) {
+  TraceLiveMap<void*> trace_live_map;
+
+  for (uintptr_t i = 1; i <= 100; ++i) {
+    EXPECT_TRUE(trace_live_map.AddMapping(reinterpret_cast<void*>(i * 16),
+                                          reinterpret_cast<void*>(i * 32)));
+  }
+
+  TraceLiveMap<void*>::Map trace_live = trace_live_map.trace_live();
+  TraceLiveMap<void*>::Map live_trace = trace_live_map.live_trace();
+  EXPECT_EQ(100U, trace_live.size());
+  EXPECT_EQ(100U, live_trace.size());
+  for (const auto& entry : trace_live)
+    EXPECT_EQ(entry.first, live_trace[entry.second]);
+
+  trace_live_map.Clear();
+  EXPECT_TRUE(trace_live_map.Empty());
+  EXPECT_TRUE(trace_live_map.trace_live().empty());
+}
+
+TEST(TraceLiveMapTest, TestConcurrentMappings) {
+  TraceLiveMap<void*> trace_live_map;
+
+  MappingRunner runner1(&trace_live_map, 1);
+  MappingRunner runner2(&trace_live_map, 1 + kMappingsPerThread);
+  MappingRunner runner3(&trace_live_map, 1 + 2 * kMappingsPerThread);
+  base::DelegateSimpleThread thread1(&runner1, "First Thread");
+  base::DelegateSimpleThread thread2(&runner2, "Second Thread");
+  base::DelegateSimpleThread thread3(&runner3, "Third Thread");
+
+  thread1.Start();
+  thread2.Start();
+  thread3.Start();
+  thread1.Join();
+  thread2.Join();
+  thread3.Join();
+
+  EXPECT_TRUE(runner1.success());
+  EXPECT_TRUE(runner2.success());
+  EXPECT_TRUE(runner3.success());
+  EXPECT_TRUE(trace_live_map.Empty());
+}
+
 }  // namespace bard
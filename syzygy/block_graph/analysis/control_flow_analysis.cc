@@ -75,6 +75,8 @@ typedef block_graph::analysis::ControlFlowAnalysis::StructuralNode
     StructuralNode;
 typedef block_graph::BasicBlockSubGraph::BasicBlock BasicBlock;
 typedef block_graph::BasicBlockSubGraph::BasicCodeBlock BasicCodeBlock;
+typedef block_graph::BasicBlockSubGraph::BasicDataBlock BasicDataBlock;
+typedef block_graph::BasicBlockSubGraph::BasicBlock::Instructions Instructions;
 typedef block_graph::BasicBlockSubGraph::BasicBlock::Successors Successors;
 typedef block_graph::BasicBlockSubGraph::BBCollection BBCollection;
 typedef block_graph::BasicBlockSubGraph::BlockDescriptionList
@@ -488,6 +490,19 @@ bool MatchLoopNode(StructuralTree* current_node,
   return false;
 }
 
+// Adds the basic blocks referred to by @p references to @p basic_blocks.
+void AddReferredBasicBlocks(
+    const BasicBlock::BasicBlockReferenceMap& references,
+    std::set<const BasicBlock*>* basic_blocks) {
+  DCHECK(basic_blocks != NULL);
+
+  BasicBlock::BasicBlockReferenceMap::const_iterator ref = references.begin();
+  for (; ref != references.end(); ++ref) {
+    if (ref->second.basic_block() != NULL)
+      basic_blocks->insert(ref->second.basic_block());
+  }
+}
+
 void DumpStructuralTreeToString(const StructuralNode* tree,
                                 size_t indent,
                                 std::stringstream* out) {
@@ -633,6 +648,41 @@ const StructuralNode* StructuralNode::body_node() const {
   return child1_.get();
 }
 
+void StructuralNode::GetBasicBlocks(
+    std::set<const BasicCodeBlock*>* basic_blocks) const {
+  DCHECK_NE(reinterpret_cast<std::set<const BasicCodeBlock*>*>(NULL),
+            basic_blocks);
+
+  switch (kind_) {
+    case kBaseNode:
+      basic_blocks->insert(root());
+      break;
+    case kSequenceNode:
+      entry_node()->GetBasicBlocks(basic_blocks);
+      sequence_node()->GetBasicBlocks(basic_blocks);
+      break;
+    case kIfThenNode:
+      entry_node()->GetBasicBlocks(basic_blocks);
+      then_node()->GetBasicBlocks(basic_blocks);
+      break;
+    case kIfThenElseNode:
+      entry_node()->GetBasicBlocks(basic_blocks);
+      then_node()->GetBasicBlocks(basic_blocks);
+      else_node()->GetBasicBlocks(basic_blocks);
+      break;
+    case kRepeatNode:
+    case kLoopNode:
+      entry_node()->GetBasicBlocks(basic_blocks);
+      break;
+    case kWhileNode:
+      entry_node()->GetBasicBlocks(basic_blocks);
+      body_node()->GetBasicBlocks(basic_blocks);
+      break;
+    default:
+      NOTREACHED() << "Invalid structural node.";
+  }
+}
+
 bool ControlFlowAnalysis::BuildStructuralTree(
     const BasicBlockSubGraph* subgraph,
     StructuralTree* tree) {
@@ -850,5 +900,42 @@ void ControlFlowAnalysis::FlattenBasicBlocksInPostOrder(
   }
 }
 
+void ControlFlowAnalysis::FindEntryBasicBlocks(
+    const BasicBlockSubGraph* subgraph,
+    std::set<const BasicBlock*>* entries) {
+  DCHECK(subgraph != NULL);
+  DCHECK(entries != NULL);
+
+  const BlockDescriptionList& descriptions = subgraph->block_descriptions();
+  BlockDescriptionList::const_iterator descr_iter = descriptions.begin();
+  for (; descr_iter != descriptions.end(); ++descr_iter) {
+    const BasicBlockSubGraph::BasicBlockOrdering& original_order =
+        descr_iter->basic_block_order;
+    if (!original_order.empty())
+      entries->insert(original_order.front());
+  }
+
+  const BBCollection& basic_blocks = subgraph->basic_blocks();
+  BBCollection::const_iterator bb_iter = basic_blocks.begin();
+  for (; bb_iter != basic_blocks.end(); ++bb_iter) {
+    const BasicBlock* bb = *bb_iter;
+    if (!bb->referrers().empty())
+      entries->insert(bb);
+
+    const BasicCodeBlock* code_bb = BasicCodeBlock::Cast(bb);
+    if (code_bb != NULL) {
+      const Instructions& instructions = code_bb->instructions();
+      Instructions::const_iterator inst_iter = instructions.begin();
+      for (; inst_iter != instructions.end(); ++inst_iter)
+        AddReferredBasicBlocks(inst_iter->references(), entries);
+      continue;
+    }
+
+    const BasicDataBlock* data_bb = BasicDataBlock::Cast(bb);
+    if (data_bb != NULL)
+      AddReferredBasicBlocks(data_bb->references(), entries);
+  }
+}
+
 }  // namespace analysis
 }  // namespace block_graph
@@ -17,6 +17,7 @@
 #ifndef SYZYGY_BLOCK_GRAPH_ANALYSIS_CONTROL_FLOW_ANALYSIS_H_
 #define SYZYGY_BLOCK_GRAPH_ANALYSIS_CONTROL_FLOW_ANALYSIS_H_
 
+#include <set>
 #include <vector>
 
 #include "syzygy/block_graph/basic_block.h"
@@ -126,6 +127,16 @@ class ControlFlowAnalysis {
       const BBCollection& basic_blocks,
       BasicBlockOrdering* order);
 
+  // Finds the basic blocks of a subgraph that may be reached otherwise than
+  // through the successors of its basic blocks. These are the heads of the
+  // blocks, the basic blocks referred to from outside of the subgraph, and
+  // those whose address is taken inside of it (e.g., the targets of a jump
+  // table). Nothing can be assumed on the paths leading to these.
+  // @param subgraph The subgraph to search.
+  // @param entries Receives the entry basic blocks.
+  static void FindEntryBasicBlocks(const BasicBlockSubGraph* subgraph,
+                                   std::set<const BasicBlock*>* entries);
+
  private:
   DISALLOW_COPY_AND_ASSIGN(ControlFlowAnalysis);
 };
@@ -215,6 +226,10 @@ class ControlFlowAnalysis::StructuralNode {
   const StructuralNode* body_node() const;
   // @}
 
+  // Collects the basic blocks of the region.
+  // @param basic_blocks receives the basic blocks of the region.
+  void GetBasicBlocks(std::set<const BasicCodeBlock*>* basic_blocks) const;
+
   // Produce a textual representation of the tree.
   // @param str receives the resulting text.
   // @returns true on success, false otherwise.
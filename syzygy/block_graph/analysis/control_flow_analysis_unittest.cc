@@ -286,6 +286,32 @@ TEST_F(ControlFlowAnalysisTest, ComplexLoopOrdering) {
               testing::ElementsAre(body1, end, if1, body2, body3, if2, if0));
 }
 
+TEST_F(ControlFlowAnalysisTest, FindEntryBasicBlocks) {
+  const uint8_t kData[4] = {};
+  BasicCodeBlock* head = subgraph_.AddBasicCodeBlock("head");
+  BasicCodeBlock* body = subgraph_.AddBasicCodeBlock("body");
+  BasicCodeBlock* target = subgraph_.AddBasicCodeBlock("target");
+  BasicDataBlock* table =
+      subgraph_.AddBasicDataBlock("table", sizeof(kData), kData);
+
+  BasicBlockSubGraph::BlockDescription* description =
+      subgraph_.AddBlockDescription("bb1", "test.obj", BlockGraph::CODE_BLOCK,
+                                    7, 2, 42);
+  description->basic_block_order.push_back(head);
+
+  MakeIf(head, body, target);
+  ASSERT_TRUE(table->SetReference(0,
+      BasicBlockReference(BlockGraph::ABSOLUTE_REF,
+                          BlockGraph::Reference::kMaximumSize,
+                          target)));
+
+  // The head of the block and the target of the table may be reached from
+  // elsewhere, but not the body.
+  std::set<const BasicBlock*> entries;
+  ControlFlowAnalysis::FindEntryBasicBlocks(&subgraph_, &entries);
+  EXPECT_THAT(entries, testing::UnorderedElementsAre(head, target));
+}
+
 TEST_F(ControlFlowAnalysisTest, SequenceStructure) {
   BasicCodeBlock* seq1 = subgraph_.AddBasicCodeBlock("seq1");
   BasicCodeBlock* seq2 = subgraph_.AddBasicCodeBlock("seq2");
@@ -512,6 +538,33 @@ TEST_F(ControlFlowAnalysisTest, RepeatIfThenStructure) {
                        Base(end)));
 }
 
+TEST_F(ControlFlowAnalysisTest, GetBasicBlocksOfRegion) {
+  BasicCodeBlock* loop = subgraph_.AddBasicCodeBlock("loop");
+  BasicCodeBlock* then = subgraph_.AddBasicCodeBlock("then");
+  BasicCodeBlock* test = subgraph_.AddBasicCodeBlock("test");
+  BasicCodeBlock* end = subgraph_.AddBasicCodeBlock("end");
+
+  MakeIf(loop, test, then);
+  Connect(then, test);
+  MakeIf(test, loop, end);
+
+  ASSERT_TRUE(BuildStructuralTree(loop));
+  ASSERT_EQ(ControlFlowAnalysis::StructuralNode::kSequenceNode,
+            tree_->kind());
+
+  std::set<const BasicCodeBlock*> basic_blocks;
+  tree_->GetBasicBlocks(&basic_blocks);
+  EXPECT_THAT(basic_blocks, testing::UnorderedElementsAre(loop, then, test,
+                                                          end));
+
+  // The loop region is made of all the basic blocks but the last one.
+  const ControlFlowAnalysis::StructuralNode* repeat = tree_->entry_node();
+  ASSERT_EQ(ControlFlowAnalysis::StructuralNode::kRepeatNode, repeat->kind());
+  basic_blocks.clear();
+  repeat->GetBasicBlocks(&basic_blocks);
+  EXPECT_THAT(basic_blocks, testing::UnorderedElementsAre(loop, then, test));
+}
+
 TEST_F(ControlFlowAnalysisTest, WhileStructure) {
   BasicCodeBlock* loop = subgraph_.AddBasicCodeBlock("loop");
   BasicCodeBlock* body = subgraph_.AddBasicCodeBlock("body");
@@ -14,6 +14,7 @@
 
 #include "syzygy/block_graph/analysis/liveness_analysis.h"
 
+#include <deque>
 #include <set>
 #include <stack>
 #include <vector>
@@ -161,45 +162,119 @@ void LivenessAnalysis::PropagateBackward(const Instruction& instr,
 
 void LivenessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
   DCHECK(subgraph != NULL);
-  DCHECK(live_in_.empty());
+  live_in_.clear();
 
   // Produce a post-order basic blocks ordering.
   const BBCollection& basic_blocks = subgraph->basic_blocks();
   std::vector<const BasicCodeBlock*> order;
   ControlFlowAnalysis::FlattenBasicBlocksInPostOrder(basic_blocks, &order);
 
-  // Initialize liveness information of each basic block (empty set).
-  BasicBlockOrdering::const_iterator fw_iter = order.begin();
-  for (; fw_iter != order.end(); ++fw_iter)
-    StateHelper::Clear(&live_in_[*fw_iter]);
+  // Initialize liveness information of each basic block (empty set), and
+  // summarize them. The summaries of the basic blocks that are no longer part
+  // of the subgraph are dropped.
+  SummaryMap previous_summaries;
+  previous_summaries.swap(summaries_);
+  std::map<const BasicBlock*, size_t> indices;
+  std::vector<const Summary*> summaries(order.size());
+  std::vector<State*> live_in(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    indices[order[i]] = i;
+    summaries[i] = &UpdateSummary(order[i], &previous_summaries);
+    live_in[i] = &live_in_[order[i]];
+    StateHelper::Clear(live_in[i]);
+  }
+
+  // Find the predecessors of each basic block within the subgraph.
+  std::vector<std::vector<size_t>> predecessors(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const Successors& successors = order[i]->successors();
+    Successors::const_iterator succ = successors.begin();
+    for (; succ != successors.end(); ++succ) {
+      std::map<const BasicBlock*, size_t>::const_iterator index =
+          indices.find(succ->reference().basic_block());
+      if (index != indices.end())
+        predecessors[index->second].push_back(i);
+    }
+  }
 
   // Propagate liveness information until stable (fix-point). Each set may only
-  // grow, thus we have a halting condition.
-  bool changed = true;
-  while (changed) {
-    changed = false;
-
-    BasicBlockOrdering::const_iterator  bb_iter = order.begin();
-    for (; bb_iter != order.end(); ++bb_iter) {
-      const BasicCodeBlock* bb = *bb_iter;
-
-      // Merge current liveness information with every successor information.
-      State state;
-      GetStateAtExitOf(bb, &state);
-
-      // Propagate liveness information backward until the basic block entry.
-      const Instructions& instructions = bb->instructions();
-      Instructions::const_reverse_iterator instr_iter = instructions.rbegin();
-      for (; instr_iter != instructions.rend(); ++instr_iter)
-        PropagateBackward(*instr_iter, &state);
-
-      // Commit liveness information to the global state.
-      if (StateHelper::Union(state, &live_in_[bb]))
-        changed = true;
+  // grow, thus we have a halting condition. Only the predecessors of a basic
+  // block whose set grew need to be visited again. The initial post-order
+  // visits most successors before their predecessors.
+  std::deque<size_t> worklist;
+  std::vector<bool> queued(order.size(), true);
+  for (size_t i = 0; i < order.size(); ++i)
+    worklist.push_back(i);
+
+  while (!worklist.empty()) {
+    size_t i = worklist.front();
+    worklist.pop_front();
+    queued[i] = false;
+
+    // Merge current liveness information with every successor information.
+    State state;
+    GetStateAtExitOf(order[i], &state);
+
+    // Apply the summary of the instructions of the basic block.
+    StateHelper::Intersect(summaries[i]->pass, &state);
+    StateHelper::Union(summaries[i]->gen, &state);
+
+    // Commit liveness information to the global state.
+    if (!StateHelper::Union(state, live_in[i]))
+      continue;
+
+    for (size_t predecessor : predecessors[i]) {
+      if (!queued[predecessor]) {
+        queued[predecessor] = true;
+        worklist.push_back(predecessor);
+      }
     }
   }
 }
 
+const LivenessAnalysis::Summary& LivenessAnalysis::UpdateSummary(
+    const BasicCodeBlock* bb, SummaryMap* previous) {
+  DCHECK(bb != NULL);
+  DCHECK(previous != NULL);
+
+  // The summary only depends on the instructions, which are fully described by
+  // their encoding.
+  std::vector<uint8_t> code;
+  const Instructions& instructions = bb->instructions();
+  Instructions::const_iterator instr_iter = instructions.begin();
+  for (; instr_iter != instructions.end(); ++instr_iter) {
+    code.push_back(static_cast<uint8_t>(instr_iter->size()));
+    code.insert(code.end(), instr_iter->data(),
+                instr_iter->data() + instr_iter->size());
+  }
+
+  Summary& summary = summaries_[bb];
+  SummaryMap::iterator look = previous->find(bb);
+  if (look != previous->end() && look->second.code == code) {
+    StateHelper::Copy(look->second.pass, &summary.pass);
+    StateHelper::Copy(look->second.gen, &summary.gen);
+    summary.code.swap(look->second.code);
+    previous->erase(look);
+    return summary;
+  }
+
+  // Propagating an empty state backward through the basic block yields the
+  // registers it uses prior to defining them. Propagating a full state yields
+  // those in addition to the registers it leaves untouched.
+  State all;
+  StateHelper::Clear(&summary.gen);
+  Instructions::const_reverse_iterator rev_iter = instructions.rbegin();
+  for (; rev_iter != instructions.rend(); ++rev_iter) {
+    PropagateBackward(*rev_iter, &summary.gen);
+    PropagateBackward(*rev_iter, &all);
+  }
+  StateHelper::Copy(all, &summary.pass);
+  StateHelper::Subtract(summary.gen, &summary.pass);
+  summary.code.swap(code);
+
+  return summary;
+}
+
 RegisterMask LivenessAnalysis::StateHelper::RegisterToRegisterMask(
     uint8_t reg) {
   LivenessAnalysis::StateHelper::RegisterBits mask =
@@ -336,6 +411,12 @@ void LivenessAnalysis::StateHelper::Subtract(const State& src, State* state) {
   state->registers_ &= ~(src.registers_);
 }
 
+void LivenessAnalysis::StateHelper::Intersect(const State& src, State* state) {
+  DCHECK(state != NULL);
+  state->flags_ &= src.flags_;
+  state->registers_ &= src.registers_;
+}
+
 void LivenessAnalysis::StateHelper::StateDefOperand(
     const _Operand& operand, State* state) {
   DCHECK(state != NULL);
@@ -28,6 +28,7 @@
 #define SYZYGY_BLOCK_GRAPH_ANALYSIS_LIVENESS_ANALYSIS_H_
 
 #include <map>
+#include <vector>
 
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
@@ -97,6 +98,12 @@ namespace analysis {
 // analysis except if a new live range escapes the scope of the basic block. In
 // that case, the whole analysis is invalid and must be recomputed.
 //
+// The analysis may be recomputed by calling 'Analyze' again on the same
+// instance. The effect of each basic block on the liveness is summarized once
+// and the summary is reused by later analyses as long as the instructions of
+// the basic block are unchanged. Hence, the transforms applied in turn to a
+// subgraph should share an instance rather than each analyzing from scratch.
+//
 // Example:
 //
 //  LivenessAnalysis liveness;
@@ -143,15 +150,31 @@ class LivenessAnalysis {
   static void PropagateBackward(const Instruction& instr, State* state);
 
   // Perform a global analysis and keep track of liveness information for each
-  // basic block.
+  // basic block. This discards the results of any previous analysis, but
+  // reuses the summaries of the basic blocks that are unchanged since.
   // @param subgraph Subgraph to apply the analysis.
   void Analyze(const BasicBlockSubGraph* subgraph);
 
  private:
+  struct Summary;
+
   // Contains the registers alive at entry of each basic block.
   typedef std::map<const BasicBlock*, State> LiveMap;
   LiveMap live_in_;
 
+  // Contains the summary of each basic block of the last analyzed subgraph.
+  typedef std::map<const BasicBlock*, Summary> SummaryMap;
+  SummaryMap summaries_;
+
+  // Get the summary of a basic block into summaries_, reusing its previous
+  // summary if the basic block is unchanged.
+  // @param bb Basic block to summarize.
+  // @param previous The summaries of the previous analysis. The summary of
+  //     @p bb is moved out of it when reused.
+  // @returns the summary of @p bb.
+  const Summary& UpdateSummary(const BasicCodeBlock* bb,
+                               SummaryMap* previous);
+
   DISALLOW_COPY_AND_ASSIGN(LivenessAnalysis);
 };
 
@@ -186,6 +209,18 @@ class LivenessAnalysis::State {
   FlagsMask flags_;
 };
 
+// The effect of a basic block on the liveness information. The registers alive
+// at entry of the basic block are '(live_out & pass) | gen', where 'live_out'
+// are those alive at its exit.
+struct LivenessAnalysis::Summary {
+  // The registers that are alive at exit and left untouched.
+  State pass;
+  // The registers used prior to being defined.
+  State gen;
+  // The length and bytes of each instruction the summary was computed from.
+  std::vector<uint8_t> code;
+};
+
 }  // namespace analysis
 }  // namespace block_graph
 
@@ -138,6 +138,11 @@ class LivenessAnalysis::StateHelper {
   // @param state State to apply modifications.
   static void Subtract(const State& src, State* state);
 
+  // Keep in @p state only the registers that are also in @p src.
+  // @param src State to intersect with.
+  // @param state State to apply modifications.
+  static void Intersect(const State& src, State* state);
+
   // Find the registers defined by an operand.
   // @param operand Operand to analyze.
   // @param state Receives defined registers.
@@ -322,6 +322,20 @@ TEST(LivenessAnalysisStateTest, StateRegisterMaskOperations) {
     StateHelper::IsPartiallySet(state_merged, StateHelper::REGBITS_AX));
   EXPECT_FALSE(
     StateHelper::IsPartiallySet(state_merged, StateHelper::REGBITS_CX));
+
+  // Test Intersect operation.
+  StateHelper::Union(state_ax, &state_merged);
+  StateHelper::Union(state_cx, &state_merged);
+  StateHelper::Intersect(state_cx, &state_merged);
+  EXPECT_FALSE(
+    StateHelper::IsPartiallySet(state_merged, StateHelper::REGBITS_AX));
+  EXPECT_TRUE(
+    StateHelper::IsPartiallySet(state_merged, StateHelper::REGBITS_CX));
+  StateHelper::Intersect(state_ax, &state_merged);
+  EXPECT_FALSE(
+    StateHelper::IsPartiallySet(state_merged, StateHelper::REGBITS_AX));
+  EXPECT_FALSE(
+    StateHelper::IsPartiallySet(state_merged, StateHelper::REGBITS_CX));
 }
 
 TEST(LivenessAnalysisStateTest, StateFlagsMaskOperations) {
@@ -1751,6 +1765,66 @@ TEST_F(LivenessAnalysisTest, LivenessAnalysisOverControlFlow) {
   EXPECT_FALSE(is_live(assm::ebp));
 }
 
+TEST_F(LivenessAnalysisTest, ReanalyzeAfterModification) {
+  BasicBlockSubGraph subgraph;
+
+  // Build and analyze this flow graph:
+  //      [bb1]
+  //      mov ecx, eax
+  //        |
+  //      [bb2]  <---
+  //      mov eax, ebx  |
+  //        |           |
+  //         -----------
+  BasicCodeBlock* bb1 = subgraph.AddBasicCodeBlock("bb1");
+  BasicCodeBlock* bb2 = subgraph.AddBasicCodeBlock("bb2");
+  ASSERT_TRUE(bb1 != NULL);
+  ASSERT_TRUE(bb2 != NULL);
+
+  AddSuccessorBetween(Successor::kConditionTrue, bb1, bb2);
+  AddSuccessorBetween(Successor::kConditionTrue, bb2, bb2);
+
+  BasicBlockAssembler asm_bb1(bb1->instructions().end(), &bb1->instructions());
+  asm_bb1.mov(assm::ecx, assm::eax);
+  BasicBlockAssembler asm_bb2(bb2->instructions().end(), &bb2->instructions());
+  asm_bb2.mov(assm::eax, assm::ebx);
+
+  for (size_t i = 0; i < 2; ++i) {
+    // Analyzing again yields the same results.
+    liveness_.Analyze(&subgraph);
+
+    liveness_.GetStateAtEntryOf(bb2, &state_);
+    EXPECT_FALSE(is_live(assm::eax));
+    EXPECT_TRUE(is_live(assm::ebx));
+    EXPECT_FALSE(is_live(assm::ecx));
+    EXPECT_FALSE(is_live(assm::edx));
+
+    liveness_.GetStateAtEntryOf(bb1, &state_);
+    EXPECT_TRUE(is_live(assm::eax));
+    EXPECT_TRUE(is_live(assm::ebx));
+    EXPECT_FALSE(is_live(assm::ecx));
+    EXPECT_FALSE(is_live(assm::edx));
+  }
+
+  // Define ebx from edx at the start of bb2, and analyze again.
+  BasicBlockAssembler asm_bb2_start(bb2->instructions().begin(),
+                                    &bb2->instructions());
+  asm_bb2_start.mov(assm::ebx, assm::edx);
+  liveness_.Analyze(&subgraph);
+
+  liveness_.GetStateAtEntryOf(bb2, &state_);
+  EXPECT_FALSE(is_live(assm::eax));
+  EXPECT_FALSE(is_live(assm::ebx));
+  EXPECT_FALSE(is_live(assm::ecx));
+  EXPECT_TRUE(is_live(assm::edx));
+
+  liveness_.GetStateAtEntryOf(bb1, &state_);
+  EXPECT_TRUE(is_live(assm::eax));
+  EXPECT_FALSE(is_live(assm::ebx));
+  EXPECT_FALSE(is_live(assm::ecx));
+  EXPECT_TRUE(is_live(assm::edx));
+}
+
 TEST_F(LivenessAnalysisTest, AnalyzeWithData) {
   BasicBlockSubGraph subgraph;
   const uint8_t raw_data[] = {0, 1, 2, 3, 4};
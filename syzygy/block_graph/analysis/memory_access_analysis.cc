@@ -14,7 +14,6 @@
 
 #include "syzygy/block_graph/analysis/memory_access_analysis.h"
 
-#include <queue>
 #include <set>
 #include <vector>
 
@@ -23,6 +22,7 @@
 //     common to get the information on registers defined or used by an
 //     instruction, or the memory operand read and written.
 #include "syzygy/assm/assembler.h"
+#include "syzygy/block_graph/analysis/control_flow_analysis.h"
 #include "syzygy/block_graph/analysis/liveness_analysis_internal.h"
 
 #include "mnemonics.h"  // NOLINT
@@ -126,80 +126,67 @@ bool MemoryAccessAnalysis::Intersect(const block_graph::BasicBlock* bb,
 
 // This function performs a global redundant memory access analysis.
 // It is a fix-point algorithm that produce the minimal set of memory locations,
-// at the entry of each basic block. The algorithm uses a work-list to follow
-// the control flow and re-insert each modified basic block into the work-list.
+// at the entry of each basic block. The basic blocks are visited in reverse
+// post-order, so that most of them are visited after all their predecessors.
 // When the end of a basic block is reached, the algorithm performs the
 // intersection of the current state with all its successors.
 void MemoryAccessAnalysis::Analyze(const BasicBlockSubGraph* subgraph) {
   DCHECK(subgraph != NULL);
 
-  std::queue<const BasicBlock*> working;
-  std::set<const BasicBlock*> marked;
-
   states_.clear();
 
-  // Find initial basic blocks (entry-points), add them to working queue.
-  const BasicBlockSubGraph::BlockDescriptionList& descriptions =
-      subgraph->block_descriptions();
-  BasicBlockSubGraph::BlockDescriptionList::const_iterator descr_iter =
-      descriptions.begin();
-  for (; descr_iter != descriptions.end(); ++descr_iter) {
-    const BasicBlockSubGraph::BasicBlockOrdering& original_order =
-        descr_iter->basic_block_order;
-    if (original_order.empty())
-      continue;
-    const BasicBlock* head = original_order.front();
-    if (marked.insert(head).second) {
-      working.push(original_order.front());
-      State empty;
-      Intersect(head, empty);
-    }
+  // Produce a post-order basic blocks ordering.
+  ControlFlowAnalysis::BasicBlockOrdering order;
+  ControlFlowAnalysis::FlattenBasicBlocksInPostOrder(subgraph->basic_blocks(),
+                                                     &order);
+
+  // Nothing is known at the entry of the basic blocks that may be reached
+  // otherwise than through a successor.
+  std::set<const BasicBlock*> entries;
+  ControlFlowAnalysis::FindEntryBasicBlocks(subgraph, &entries);
+  std::set<const BasicBlock*>::const_iterator entry = entries.begin();
+  for (; entry != entries.end(); ++entry) {
+    State empty;
+    Intersect(*entry, empty);
   }
 
-  DCHECK(!working.empty());
-
-  // Working set algorithm until fixed point.
-  while (!working.empty()) {
-    const BasicBlock* bb = working.front();
-    working.pop();
-    marked.erase(bb);
-
-    const BasicCodeBlock* bb_code = BasicCodeBlock::Cast(bb);
-    if (bb_code == NULL) {
-      // Invalidate all.
-      states_.clear();
-      return;
-    }
-
-    State state;
-    GetStateAtEntryOf(bb, &state);
-
-    // Walk through this basic block to obtain an updated state.
-    const Instructions& instructions = bb_code->instructions();
-    Instructions::const_iterator inst_iter = instructions.begin();
-    for ( ; inst_iter != instructions.end(); ++inst_iter) {
-      const Instruction& inst = *inst_iter;
-      PropagateForward(inst, &state);
-    }
-
-    // Commit updated state to successors, and re-insert modified basic blocks
-    // to the working queue to be processed again.
-    const BasicBlock::Successors& successors = bb_code->successors();
-    BasicBlock::Successors::const_iterator succ = successors.begin();
-    for (; succ != successors.end(); ++succ) {
-      BasicBlock* basic_block = succ->reference().basic_block();
-      if (basic_block == NULL) {
-        // Invalidate all.
-        states_.clear();
-        return;
+  // Propagate the memory accesses until stable (fix-point). Each set may only
+  // shrink once it has been created, thus we have a halting condition.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    ControlFlowAnalysis::BasicBlockOrdering::const_reverse_iterator bb_iter =
+        order.rbegin();
+    for (; bb_iter != order.rend(); ++bb_iter) {
+      const BasicCodeBlock* bb = *bb_iter;
+
+      // Skip the basic blocks that haven't been reached yet.
+      if (states_.find(bb) == states_.end())
+        continue;
+
+      State state;
+      GetStateAtEntryOf(bb, &state);
+
+      // Walk through this basic block to obtain an updated state.
+      const Instructions& instructions = bb->instructions();
+      Instructions::const_iterator inst_iter = instructions.begin();
+      for ( ; inst_iter != instructions.end(); ++inst_iter) {
+        const Instruction& inst = *inst_iter;
+        PropagateForward(inst, &state);
       }
 
-      // Intersect current state with successor 'basic_block'.
-      bool changed = Intersect(basic_block, state);
-      if (changed) {
-        // When not already in working queue, mark and add it.
-        if (marked.insert(basic_block).second)
-          working.push(basic_block);
+      // Commit updated state to successors. Successors outside of the subgraph,
+      // like the targets of tail calls, need no state.
+      const BasicBlock::Successors& successors = bb->successors();
+      BasicBlock::Successors::const_iterator succ = successors.begin();
+      for (; succ != successors.end(); ++succ) {
+        const BasicBlock* basic_block = succ->reference().basic_block();
+        if (basic_block == NULL)
+          continue;
+
+        if (Intersect(basic_block, state))
+          changed = true;
       }
     }
   }
@@ -260,6 +247,16 @@ bool MemoryAccessAnalysis::State::HasNonRedundantAccess(
   return false;
 }
 
+bool MemoryAccessAnalysis::State::HasAccess(RegisterId base_reg,
+                                            int32_t displacement) const {
+  if (base_reg < assm::kRegister32Min || base_reg >= assm::kRegister32Max)
+    return false;
+
+  const std::set<int32_t>& accesses =
+      active_memory_accesses_[base_reg - assm::kRegister32Min];
+  return accesses.find(displacement) != accesses.end();
+}
+
 void MemoryAccessAnalysis::State::Execute(const Instruction& instr) {
   const _DInst& repr = instr.representation();
 
@@ -162,6 +162,13 @@ class MemoryAccessAnalysis::State {
   // @returns true if memory accesses are redundant, false otherwise.
   bool HasNonRedundantAccess(const Instruction& instr) const;
 
+  // Check whether a memory location was accessed through a base register,
+  // which has been left unchanged since.
+  // @param base_reg The base register of the access.
+  // @param displacement The displacement of the access.
+  // @returns true if the access is in this state, false otherwise.
+  bool HasAccess(assm::RegisterId base_reg, int32_t displacement) const;
+
  protected:
   // Remove all accessed memory locations from state.
   void Clear();
@@ -294,6 +294,19 @@ TEST(MemoryAccessAnalysisStateTest, HasNonRedundantAccessOperandKind) {
   EXPECT_TRUE(state.HasNonRedundantAccess(kWriteEax42));
 }
 
+TEST(MemoryAccessAnalysisStateTest, HasAccess) {
+  TestMemoryAccessAnalysisState state;
+  EXPECT_FALSE(state.HasAccess(assm::kRegisterEax, 42));
+
+  state.Execute(kReadEax42);
+  EXPECT_TRUE(state.HasAccess(assm::kRegisterEax, 42));
+  EXPECT_FALSE(state.HasAccess(assm::kRegisterEax, 0));
+  EXPECT_FALSE(state.HasAccess(assm::kRegisterEcx, 42));
+
+  // Registers that aren't 32-bit are never used as a base.
+  EXPECT_FALSE(state.HasAccess(assm::kRegisterNone, 42));
+}
+
 TEST(MemoryAccessAnalysisStateTest, HasNonRedundantAccessWithPrefix) {
   TestMemoryAccessAnalysisState state;
   state.Execute(kRepMovsb);
@@ -526,5 +539,94 @@ TEST_F(MemoryAccessAnalysisTest, AnalyzeWithData) {
   EXPECT_TRUE(state_.IsEmpty());
 }
 
+TEST_F(MemoryAccessAnalysisTest, AnalyzeWithTailCall) {
+  BasicBlockSubGraph subgraph;
+  BlockGraph block_graph;
+  BlockGraph::Block* callee =
+      block_graph.AddBlock(BlockGraph::CODE_BLOCK, 10, "callee");
+
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  BasicCodeBlock* bb_if = subgraph.AddBasicCodeBlock("if");
+  BasicCodeBlock* bb_true = subgraph.AddBasicCodeBlock("true");
+  BasicCodeBlock* bb_false = subgraph.AddBasicCodeBlock("false");
+
+  block->basic_block_order.push_back(bb_if);
+  block->basic_block_order.push_back(bb_true);
+  block->basic_block_order.push_back(bb_false);
+
+  AddSuccessorBetween(Successor::kConditionEqual, bb_if, bb_true);
+  AddSuccessorBetween(Successor::kConditionNotEqual, bb_if, bb_false);
+
+  // bb_true tail calls another block.
+  bb_true->successors().push_back(
+      Successor(Successor::kConditionTrue,
+                BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                    BlockGraph::Reference::kMaximumSize,
+                                    callee, 0, 0),
+                0));
+
+  BasicBlockAssembler asm_if(bb_if->instructions().end(),
+                             &bb_if->instructions());
+  asm_if.mov(assm::ecx, Operand(assm::eax, Displacement(1, assm::kSize32Bit)));
+
+  BasicBlockAssembler asm_false(bb_false->instructions().end(),
+                                &bb_false->instructions());
+  asm_false.ret();
+
+  // Analyze the flow graph.
+  memory_access_.Analyze(&subgraph);
+
+  // The tail call doesn't prevent the propagation to the other basic blocks.
+  GetStateAtEntryOf(bb_true, &state_);
+  EXPECT_TRUE(state_.Contains(assm::eax, 1));
+  GetStateAtEntryOf(bb_false, &state_);
+  EXPECT_TRUE(state_.Contains(assm::eax, 1));
+}
+
+TEST_F(MemoryAccessAnalysisTest, AnalyzeWithJumpTable) {
+  BasicBlockSubGraph subgraph;
+  const uint8_t raw_data[] = {0, 1, 2, 3};
+  const size_t raw_data_len = ARRAYSIZE(raw_data);
+
+  BlockDescription* block = subgraph.AddBlockDescription(
+      "b1", "b1.obj", BlockGraph::CODE_BLOCK, 7, 2, 42);
+
+  BasicCodeBlock* bb_head = subgraph.AddBasicCodeBlock("head");
+  BasicCodeBlock* bb_case = subgraph.AddBasicCodeBlock("case");
+  BasicDataBlock* table =
+      subgraph.AddBasicDataBlock("table", raw_data_len, &raw_data[0]);
+
+  block->basic_block_order.push_back(bb_head);
+  block->basic_block_order.push_back(bb_case);
+  block->basic_block_order.push_back(table);
+
+  AddSuccessorBetween(Successor::kConditionTrue, bb_head, bb_case);
+
+  // bb_case is also the target of a jump table, which may be reached from
+  // anywhere.
+  ASSERT_TRUE(table->SetReference(0,
+      BasicBlockReference(BlockGraph::ABSOLUTE_REF,
+                          BlockGraph::Reference::kMaximumSize,
+                          bb_case)));
+
+  BasicBlockAssembler asm_head(bb_head->instructions().end(),
+                               &bb_head->instructions());
+  asm_head.mov(assm::ecx,
+               Operand(assm::eax, Displacement(1, assm::kSize32Bit)));
+
+  BasicBlockAssembler asm_case(bb_case->instructions().end(),
+                               &bb_case->instructions());
+  asm_case.ret();
+
+  // Analyze the flow graph.
+  memory_access_.Analyze(&subgraph);
+
+  // Nothing is known at the entry of the target of the jump table.
+  GetStateAtEntryOf(bb_case, &state_);
+  EXPECT_TRUE(state_.IsEmpty());
+}
+
 }  // namespace analysis
 }  // namespace block_graph
@@ -267,6 +267,15 @@ bool Instruction::FromBuffer(const uint8_t* buf,
   return true;
 }
 
+void Instruction::FromRepresentation(const Representation& repr,
+                                     const uint8_t* buf,
+                                     Instruction* inst) {
+  DCHECK(buf != NULL);
+  DCHECK(inst != NULL);
+
+  *inst = Instruction(repr, buf);
+}
+
 const char* Instruction::GetName() const {
   // The mnemonics are defined as NUL terminated unsigned char arrays.
   return reinterpret_cast<char*>(GET_MNEMONIC_NAME(representation_.opcode));
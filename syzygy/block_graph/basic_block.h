@@ -260,6 +260,16 @@ class Instruction {
   // @returns true on success, false otherwise.
   static bool FromBuffer(const uint8_t* buf, uint32_t len, Instruction* inst);
 
+  // Factory to construct an Instruction instance from an already decoded
+  // representation.
+  // @param repr the decoded representation of the instruction.
+  // @param buf the data comprising the instruction, at least @p repr.size
+  //     bytes of it.
+  // @param inst receives the instruction.
+  static void FromRepresentation(const Representation& repr,
+                                 const uint8_t* buf,
+                                 Instruction* inst);
+
   // Accessors.
   // @{
   const Representation& representation() const { return representation_; }
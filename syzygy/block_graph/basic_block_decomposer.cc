@@ -25,6 +25,7 @@
 #include "syzygy/block_graph/basic_block_subgraph.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/block_graph/block_util.h"
+#include "syzygy/block_graph/decoded_instruction_cache.h"
 
 #include "mnemonics.h"  // NOLINT
 
@@ -240,6 +241,14 @@ bool BasicBlockDecomposer::DecodeInstruction(Offset offset,
     return false;
   }
 
+  AnnotateInstruction(offset, instruction);
+  return true;
+}
+
+void BasicBlockDecomposer::AnnotateInstruction(
+    Offset offset, Instruction* instruction) const {
+  DCHECK(instruction != NULL);
+
   VLOG(3) << "Disassembled " << instruction->GetName()
           << " instruction (" << instruction->size()
           << " bytes) at offset " << offset << ".";
@@ -257,8 +266,6 @@ bool BasicBlockDecomposer::DecodeInstruction(Offset offset,
         << block_->name() << ".";
     instruction->set_label(label);
   }
-
-  return true;
 }
 
 BasicBlockDecomposer::SourceRange BasicBlockDecomposer::GetSourceRange(
@@ -568,14 +575,33 @@ bool BasicBlockDecomposer::ParseInstructions() {
   // Initialize jump_targets_ to include un-discoverable targets.
   InitJumpTargets(code_end_offset);
 
+  // Decode the code bytes in bulk.
+  DecodedInstructionCache::Run scratch_run;
+  const DecodedInstructionCache::Run* run = &scratch_run;
+  DecodedInstructionCache* cache = DecodedInstructionCache::current();
+  if (cache != NULL) {
+    run = cache->Decode(block_->data(), code_end_offset);
+  } else {
+    DecodedInstructionCache::DecodeRun(block_->data(), code_end_offset,
+                                       &scratch_run);
+  }
+
   // Disassemble the instruction stream into rudimentary basic blocks.
   Offset offset = 0;
+  size_t index = 0;
   current_block_start_ = offset;
   while (offset < code_end_offset) {
-    // Decode the next instruction.
+    // Get the next instruction. Past the end of the decoded run this decodes
+    // the offending bytes again, which fails and reports them.
     Instruction instruction;
-    if (!DecodeInstruction(offset, code_end_offset, &instruction))
+    if (index < run->instructions.size()) {
+      Instruction::FromRepresentation(run->instructions[index++],
+                                      block_->data() + offset,
+                                      &instruction);
+      AnnotateInstruction(offset, &instruction);
+    } else if (!DecodeInstruction(offset, code_end_offset, &instruction)) {
       return false;
+    }
 
     // Handle the decoded instruction.
     if (!HandleInstruction(instruction, offset))
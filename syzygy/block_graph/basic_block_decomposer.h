@@ -148,6 +148,8 @@ class BasicBlockDecomposer {
   // block into rudimentary basic blocks. The initial set of basic blocks are
   // each terminated at branch points. A subsequent pass will further split
   // basic blocks at branch destinations, see SplitCodeBlocksAtBranchTargets().
+  // The code bytes are decoded in bulk, via the current
+  // DecodedInstructionCache if there is one.
   bool ParseInstructions();
 
   // @name Helpers for ParseInstructions().
@@ -172,6 +174,13 @@ class BasicBlockDecomposer {
                          Offset code_end_offset,
                          Instruction* instruction) const;
 
+  // Attaches the source range and the label, if any, of the bytes at
+  // @p offset to the freshly decoded @p instruction.
+  // @param offset The offset of into block_ at which @p instruction occurs.
+  // @param instruction The instruction to annotate.
+  // @note Used by ParseInstructions().
+  void AnnotateInstruction(Offset offset, Instruction* instruction) const;
+
   // Called for each instruction, this creates the Instruction object
   // corresponding to @p instruction, or terminates the current basic block
   // if @p instruction is a branch point.
@@ -170,7 +170,13 @@ class MergeContext {
     const Successor* successor;
   };
   struct BasicBlockLayoutInfo {
-    // The basic block this layout info concerns. Useful for debugging.
+    BasicBlockLayoutInfo()
+        : basic_block(NULL), block(NULL), start_offset(0),
+          basic_block_size(0) {
+    }
+
+    // The basic block this layout info concerns, or NULL if the basic block
+    // with the corresponding ID isn't laid out.
     const BasicBlock* basic_block;
 
     // Stores the block that basic_block will be manifested in.
@@ -191,11 +197,13 @@ class MergeContext {
     // Layout info for this block's successors.
     SuccessorLayoutInfo successors[2];
   };
-  typedef std::map<const BasicBlock*, BasicBlockLayoutInfo>
-      BasicBlockLayoutInfoMap;
+  // The layout info is indexed by basic block ID. These are allocated
+  // sequentially by the subgraph, so the vector is dense.
+  typedef std::vector<BasicBlockLayoutInfo> BasicBlockLayoutInfoVector;
 
-  // Update the new block with the source range for the bytes in the
-  // range [new_offset, new_offset + new_size).
+  // Record the source range for the bytes in the range
+  // [new_offset, new_offset + new_size) of the new block. The source ranges
+  // of the block are built once it is populated.
   // @param source_range The source range (if any) to assign.
   // @param new_offset The offset in the new block where the original bytes
   //     will now live.
@@ -308,7 +316,7 @@ class MergeContext {
   const BasicBlockSubGraph* sub_graph_;
 
   // Layout info.
-  BasicBlockLayoutInfoMap layout_info_;
+  BasicBlockLayoutInfoVector layout_info_;
 
   // The block graph in which the new blocks are generated.
   BlockGraph* const block_graph_;
@@ -322,6 +330,9 @@ class MergeContext {
   // The set of blocks generated in this context so far.
   BlockVector new_blocks_;
 
+  // Collects the source ranges of the block being populated.
+  Block::SourceRangesBuilder source_ranges_builder_;
+
   DISALLOW_COPY_AND_ASSIGN(MergeContext);
 };
 
@@ -349,9 +360,11 @@ bool MergeContext::GenerateBlocks(const BasicBlockSubGraph& subgraph) {
 
 void MergeContext::TransferReferrers(const BasicBlockSubGraph* subgraph) const {
   // Iterate through the layout info, and update each referenced BB.
-  BasicBlockLayoutInfoMap::const_iterator it = layout_info_.begin();
-  for (; it != layout_info_.end(); ++it)
-    UpdateReferrers(it->second.basic_block);
+  BasicBlockLayoutInfoVector::const_iterator it = layout_info_.begin();
+  for (; it != layout_info_.end(); ++it) {
+    if (it->basic_block != NULL)
+      UpdateReferrers(it->basic_block);
+  }
 }
 
 void MergeContext::CopySourceRange(const SourceRange& source_range,
@@ -365,10 +378,10 @@ void MergeContext::CopySourceRange(const SourceRange& source_range,
   if (source_range.size() == 0)
     return;
 
-  // Insert the new source range mapping into the new block.
-  bool inserted = new_block->source_ranges().Insert(
+  // Collect the new source range mapping.
+  bool added = source_ranges_builder_.Add(
       Block::DataRange(new_offset, new_size), source_range);
-  DCHECK(inserted);
+  DCHECK(added);
 }
 
 bool MergeContext::AssembleSuccessors(const BasicBlockLayoutInfo& info) {
@@ -599,9 +612,9 @@ bool MergeContext::InitializeBlockLayout(const BasicBlockOrdering& order,
       new_block->set_alignment(bb->alignment());
 
     // Create and initialize the layout info for this block.
-    DCHECK(layout_info_.find(bb) == layout_info_.end());
-
-    BasicBlockLayoutInfo& info = layout_info_[bb];
+    DCHECK_GT(layout_info_.size(), bb->id());
+    BasicBlockLayoutInfo& info = layout_info_[bb->id()];
+    DCHECK(info.basic_block == NULL);
     info.basic_block = bb;
     info.block = new_block;
     info.start_offset = 0;
@@ -735,25 +748,34 @@ bool MergeContext::InitializeBlockLayout(const BasicBlockOrdering& order,
 }
 
 bool MergeContext::GenerateBlockLayout(const BasicBlockOrdering& order) {
+  // Flatten the ordering once, and note the basic blocks that have successors
+  // to size, so that the passes below are straight walks over arrays.
+  std::vector<BasicBlockLayoutInfo*> infos;
+  std::vector<BasicBlockLayoutInfo*> infos_with_successors;
+  infos.reserve(order.size());
   BasicBlockOrderingConstIter it = order.begin();
+  for (; it != order.end(); ++it) {
+    BasicBlockLayoutInfo& info = FindLayoutInfo(*it);
+    infos.push_back(&info);
+    if (info.successors[0].successor != NULL)
+      infos_with_successors.push_back(&info);
+  }
+  DCHECK(!infos.empty());
+  Block* new_block = infos.front()->block;
 
-  // Loop over the layout, expanding successors until stable.
+  // Loop over the layout, expanding successors until stable. Successors only
+  // ever grow, so this converges.
   while (true) {
     bool expanded_successor = false;
 
     // Update the start offset for each of the BBs, respecting the BB alignment
     // constraints.
-    it = order.begin();
     Offset next_block_start = 0;
-    Block* new_block = NULL;
-    for (; it != order.end(); ++it) {
-      BasicBlockLayoutInfo& info = FindLayoutInfo(*it);
+    for (BasicBlockLayoutInfo* info_ptr : infos) {
+      BasicBlockLayoutInfo& info = *info_ptr;
       next_block_start = common::AlignUp(next_block_start,
                                          info.basic_block->alignment());
       info.start_offset = next_block_start;
-
-      if (new_block == NULL)
-        new_block = info.block;
       DCHECK(new_block == info.block);
 
       next_block_start += info.basic_block_size +
@@ -762,10 +784,8 @@ bool MergeContext::GenerateBlockLayout(const BasicBlockOrdering& order) {
     }
 
     // See whether there's a need to expand the successor sizes.
-    it = order.begin();
-    for (; it != order.end(); ++it) {
-      const BasicBlock* bb = *it;
-      BasicBlockLayoutInfo& info = FindLayoutInfo(bb);
+    for (BasicBlockLayoutInfo* info_ptr : infos_with_successors) {
+      BasicBlockLayoutInfo& info = *info_ptr;
 
       // Compute the start offset for this block's first successor.
       Offset start_offset = info.start_offset + info.basic_block_size;
@@ -816,6 +836,12 @@ bool MergeContext::GenerateBlockLayout(const BasicBlockOrdering& order) {
 }
 
 bool MergeContext::GenerateLayout(const BasicBlockSubGraph& subgraph) {
+  // Make room for the layout info of every basic block of the subgraph. The
+  // basic blocks are ordered by ID, so the last one has the largest.
+  DCHECK(layout_info_.empty());
+  if (!subgraph.basic_blocks().empty())
+    layout_info_.resize((*subgraph.basic_blocks().rbegin())->id() + 1);
+
   // Create each new block and initialize a layout for it.
   BlockDescriptionConstIter it = subgraph.block_descriptions().begin();
   for (; it != subgraph.block_descriptions().end(); ++it) {
@@ -876,6 +902,7 @@ bool MergeContext::PopulateBlock(const BasicBlockOrdering& order) {
   BasicBlockOrderingConstIter bb_end = order.end();
 
   BlockGraph::Offset prev_offset = 0;
+  source_ranges_builder_.clear();
 
   for (; bb_iter != bb_end; ++bb_iter) {
     const BasicBlock* bb = *bb_iter;
@@ -952,6 +979,12 @@ bool MergeContext::PopulateBlock(const BasicBlockOrdering& order) {
     DCHECK(code_block != NULL || data_block != NULL || end_block != NULL);
   }
 
+  // Build the source ranges of the new block in one pass.
+  Block* new_block = FindLayoutInfo(*order.begin()).block;
+  size_t conflicts =
+      source_ranges_builder_.Build(&new_block->source_ranges());
+  DCHECK_EQ(0U, conflicts);
+
   return true;
 }
 
@@ -976,10 +1009,7 @@ void MergeContext::UpdateReferrers(const BasicBlock* bb) const {
   DCHECK_NE(reinterpret_cast<BasicBlock*>(NULL), bb);
 
   // Find the current location of this basic block.
-  BasicBlockLayoutInfoMap::const_iterator layout_it = layout_info_.find(bb);
-  DCHECK(layout_it != layout_info_.end());
-  const BasicBlockLayoutInfo& info = layout_it->second;
-  DCHECK_EQ(bb, info.basic_block);
+  const BasicBlockLayoutInfo& info = FindLayoutInfo(bb);
 
   // Update all external referrers to point to the new location.
   const BasicBlock::BasicBlockReferrerSet& referrers = bb->referrers();
@@ -1126,20 +1156,22 @@ Size MergeContext::ComputeRequiredSuccessorSize(
 
 MergeContext::BasicBlockLayoutInfo& MergeContext::FindLayoutInfo(
     const BasicBlock* bb) {
-  BasicBlockLayoutInfoMap::iterator it = layout_info_.find(bb);
-  DCHECK(it != layout_info_.end());
-  DCHECK_EQ(bb, it->second.basic_block);
+  DCHECK_NE(reinterpret_cast<const BasicBlock*>(NULL), bb);
+  DCHECK_GT(layout_info_.size(), bb->id());
+  BasicBlockLayoutInfo& info = layout_info_[bb->id()];
+  DCHECK_EQ(bb, info.basic_block);
 
-  return it->second;
+  return info;
 }
 
 const MergeContext::BasicBlockLayoutInfo& MergeContext::FindLayoutInfo(
     const BasicBlock* bb) const {
-  BasicBlockLayoutInfoMap::const_iterator it = layout_info_.find(bb);
-  DCHECK(it != layout_info_.end());
-  DCHECK_EQ(bb, it->second.basic_block);
+  DCHECK_NE(reinterpret_cast<const BasicBlock*>(NULL), bb);
+  DCHECK_GT(layout_info_.size(), bb->id());
+  const BasicBlockLayoutInfo& info = layout_info_[bb->id()];
+  DCHECK_EQ(bb, info.basic_block);
 
-  return it->second;
+  return info;
 }
 
 BlockGraph::Reference MergeContext::ResolveReference(
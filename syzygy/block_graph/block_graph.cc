@@ -18,6 +18,7 @@
 
 #include "base/logging.h"
 #include "base/strings/stringprintf.h"
+#include "syzygy/block_graph/block_graph_journal.h"
 
 // Pretty prints a BlockInfo to an ostream. This has to be outside of any
 // namespaces so that operator<< is found properly.
@@ -256,12 +257,23 @@ const BlockGraph::SectionId BlockGraph::kInvalidSectionId = SIZE_MAX;
 BlockGraph::BlockGraph()
     : next_section_id_(0),
       next_block_id_(0),
-      image_format_(UNKNOWN_IMAGE_FORMAT) {
+      image_format_(UNKNOWN_IMAGE_FORMAT),
+      journal_(NULL) {
 }
 
 BlockGraph::~BlockGraph() {
 }
 
+void BlockGraph::EnableArenaStorage() {
+  DCHECK(blocks_.empty());
+  if (arena_.get() != NULL)
+    return;
+
+  arena_.reset(new BlockGraphArena());
+  blocks_ = BlockMap(BlockMap::key_compare(),
+                     BlockMap::allocator_type(arena_.get()));
+}
+
 BlockGraph::Section* BlockGraph::AddSection(const base::StringPiece& name,
                                             uint32_t characteristics) {
   Section new_section(next_section_id_++, name, characteristics);
@@ -329,6 +341,8 @@ BlockGraph::Block* BlockGraph::AddBlock(BlockType type,
   BlockId id = ++next_block_id_;
   BlockMap::iterator it = blocks_.insert(
       std::make_pair(id, Block(id, type, size, name, this))).first;
+  if (journal_ != NULL)
+    journal_->RecordBlockAdded(id);
 
   return &it->second;
 }
@@ -442,11 +456,19 @@ bool BlockGraph::RemoveBlockByIterator(BlockMap::iterator it) {
   if (it->second.referrers().size() > 0 || it->second.references().size() > 0)
     return false;
 
+  BlockId id = it->first;
   blocks_.erase(it);
+  if (journal_ != NULL)
+    journal_->RecordBlockRemoved(id);
 
   return true;
 }
 
+void BlockGraph::RecordBlockChangesImpl(BlockId id, BlockChanges changes) {
+  DCHECK(journal_ != NULL);
+  journal_->RecordBlockChanges(id, changes);
+}
+
 BlockGraph::AddressSpace::AddressSpace(BlockGraph* graph)
     : graph_(graph) {
   DCHECK(graph != NULL);
@@ -879,9 +901,16 @@ BlockGraph::Block::Block(BlockGraph* block_graph)
       block_graph_(block_graph),
       section_(kInvalidSectionId),
       attributes_(0U),
+      references_(ReferenceMap::key_compare(),
+                  ReferenceMap::allocator_type(block_graph->arena())),
+      referrers_(ReferrerSet::key_compare(),
+                 ReferrerSet::allocator_type(block_graph->arena())),
+      labels_(LabelMap::key_compare(),
+              LabelMap::allocator_type(block_graph->arena())),
       owns_data_(false),
       data_(NULL),
-      data_size_(0U) {
+      data_size_(0U),
+      change_count_(0U) {
   DCHECK(block_graph != NULL);
 }
 
@@ -902,11 +931,43 @@ BlockGraph::Block::Block(BlockId id,
       block_graph_(block_graph),
       section_(kInvalidSectionId),
       attributes_(0U),
+      references_(ReferenceMap::key_compare(),
+                  ReferenceMap::allocator_type(block_graph->arena())),
+      referrers_(ReferrerSet::key_compare(),
+                 ReferrerSet::allocator_type(block_graph->arena())),
+      labels_(LabelMap::key_compare(),
+              LabelMap::allocator_type(block_graph->arena())),
       owns_data_(false),
       data_(NULL),
-      data_size_(0U) {
+      data_size_(0U),
+      change_count_(0U) {
   DCHECK(block_graph != NULL);
-  set_name(name);
+  // This doesn't use set_name, as the block isn't in the block graph yet and
+  // there's no change to record.
+  name_ = &block_graph->string_table().InternString(name);
+}
+
+BlockGraph::Block::Block(const Block& other)
+    : id_(other.id_),
+      type_(other.type_),
+      size_(other.size_),
+      alignment_(other.alignment_),
+      alignment_offset_(other.alignment_offset_),
+      padding_before_(other.padding_before_),
+      name_(other.name_),
+      compiland_name_(other.compiland_name_),
+      addr_(other.addr_),
+      block_graph_(other.block_graph_),
+      section_(other.section_),
+      attributes_(other.attributes_),
+      references_(other.references_, other.references_.get_allocator()),
+      referrers_(other.referrers_, other.referrers_.get_allocator()),
+      source_ranges_(other.source_ranges_),
+      labels_(other.labels_, other.labels_.get_allocator()),
+      owns_data_(other.owns_data_),
+      data_(other.data_),
+      data_size_(other.data_size_),
+      change_count_(other.change_count_) {
 }
 
 BlockGraph::Block::~Block() {
@@ -920,6 +981,7 @@ void BlockGraph::Block::set_name(const base::StringPiece& name) {
   const std::string& interned_name =
       block_graph_->string_table().InternString(name);
   name_ = &interned_name;
+  RecordChanges(BLOCK_PROPERTIES_CHANGED);
 }
 
 const std::string& BlockGraph::Block::compiland_name() const {
@@ -934,6 +996,7 @@ void BlockGraph::Block::set_compiland_name(const base::StringPiece& name) {
   const std::string& interned_name =
       block_graph_->string_table().InternString(name);
   compiland_name_ = &interned_name;
+  RecordChanges(BLOCK_PROPERTIES_CHANGED);
 }
 
 uint8_t* BlockGraph::Block::AllocateRawData(size_t data_size) {
@@ -952,6 +1015,7 @@ uint8_t* BlockGraph::Block::AllocateRawData(size_t data_size) {
   data_ = new_data;
   data_size_ = data_size;
   owns_data_ = true;
+  RecordChanges(BLOCK_DATA_CHANGED);
 
   return new_data;
 }
@@ -963,6 +1027,10 @@ void BlockGraph::Block::InsertData(Offset offset,
   DCHECK_LE(offset, static_cast<Offset>(size_));
 
   if (size > 0) {
+    RecordChanges(BLOCK_PROPERTIES_CHANGED | BLOCK_LABELS_CHANGED |
+                  BLOCK_REFERENCES_CHANGED | BLOCK_REFERRERS_CHANGED);
+    RecordShiftChanges();
+
     // Patch up the block.
     size_ += size;
     ShiftOffsetItemMap(offset, size, &labels_);
@@ -1022,6 +1090,10 @@ bool BlockGraph::Block::RemoveData(Offset offset, Size size) {
     }
   }
 
+  RecordChanges(BLOCK_PROPERTIES_CHANGED | BLOCK_LABELS_CHANGED |
+                BLOCK_REFERENCES_CHANGED | BLOCK_REFERRERS_CHANGED);
+  RecordShiftChanges();
+
   // Patch up the block.
   size_ -= size;
   ShiftOffsetItemMap(offset + size, -static_cast<int>(size), &labels_);
@@ -1092,6 +1164,7 @@ void BlockGraph::Block::SetData(const uint8_t* data, size_t data_size) {
   owns_data_ = false;
   data_ = data;
   data_size_ = data_size;
+  RecordChanges(BLOCK_DATA_CHANGED);
 }
 
 uint8_t* BlockGraph::Block::AllocateData(size_t size) {
@@ -1143,6 +1216,7 @@ const uint8_t* BlockGraph::Block::ResizeData(size_t new_size) {
     data_ = new_data;
     data_size_ = new_size;
   }
+  RecordChanges(BLOCK_DATA_CHANGED);
 
   return data_;
 }
@@ -1162,6 +1236,9 @@ uint8_t* BlockGraph::Block::GetMutableData() {
   }
   DCHECK(owns_data_);
 
+  // The caller is presumably about to change the data.
+  RecordChanges(BLOCK_DATA_CHANGED);
+
   return const_cast<uint8_t*>(data_);
 }
 
@@ -1229,6 +1306,7 @@ bool BlockGraph::Block::SetReference(Offset offset, const Reference& ref) {
     Referrer referrer(this, offset);
     size_t removed = referenced->referrers_.erase(referrer);
     DCHECK_EQ(1U, removed);
+    referenced->RecordChanges(BLOCK_REFERRERS_CHANGED);
 
     // Lastly switch the reference.
     it->second = ref;
@@ -1240,6 +1318,8 @@ bool BlockGraph::Block::SetReference(Offset offset, const Reference& ref) {
 
   // Record the back-reference.
   ref.referenced()->referrers_.insert(std::make_pair(this, offset));
+  ref.referenced()->RecordChanges(BLOCK_REFERRERS_CHANGED);
+  RecordChanges(BLOCK_REFERENCES_CHANGED);
 
   return inserted;
 }
@@ -1266,6 +1346,8 @@ bool BlockGraph::Block::RemoveReference(Offset offset) {
   size_t removed = referenced->referrers_.erase(referrer);
   DCHECK_EQ(1U, removed);
   references_.erase(it);
+  referenced->RecordChanges(BLOCK_REFERRERS_CHANGED);
+  RecordChanges(BLOCK_REFERENCES_CHANGED);
 
   return true;
 }
@@ -1288,6 +1370,8 @@ bool BlockGraph::Block::RemoveAllReferences() {
     size_t removed = referenced->referrers_.erase(referrer);
     DCHECK_EQ(1U, removed);
     references_.erase(to_remove);
+    referenced->RecordChanges(BLOCK_REFERRERS_CHANGED);
+    RecordChanges(BLOCK_REFERENCES_CHANGED);
   }
 
   return true;
@@ -1306,8 +1390,10 @@ bool BlockGraph::Block::SetLabel(Offset offset, const Label& label) {
       labels_.insert(std::make_pair(offset, label)));
 
   // If it was freshly inserted then we're done.
-  if (result.second)
+  if (result.second) {
+    RecordChanges(BLOCK_LABELS_CHANGED);
     return true;
+  }
 
   return false;
 }
@@ -1327,7 +1413,11 @@ bool BlockGraph::Block::GetLabel(Offset offset, Label* label) const {
 bool BlockGraph::Block::RemoveLabel(Offset offset) {
   DCHECK(offset >= 0 && static_cast<size_t>(offset) <= size_);
 
-  return labels_.erase(offset) == 1;
+  if (labels_.erase(offset) != 1)
+    return false;
+
+  RecordChanges(BLOCK_LABELS_CHANGED);
+  return true;
 }
 
 bool BlockGraph::Block::HasLabel(Offset offset) const {
@@ -1379,6 +1469,20 @@ bool BlockGraph::Block::TransferReferrers(Offset offset,
   return true;
 }
 
+void BlockGraph::Block::RecordShiftChanges() {
+  DCHECK(block_graph_ != NULL);
+  if (block_graph_->journal() == NULL)
+    return;
+
+  ReferrerSet::const_iterator referrer_it = referrers_.begin();
+  for (; referrer_it != referrers_.end(); ++referrer_it)
+    referrer_it->first->RecordChanges(BLOCK_REFERENCES_CHANGED);
+
+  ReferenceMap::const_iterator reference_it = references_.begin();
+  for (; reference_it != references_.end(); ++reference_it)
+    reference_it->second.referenced()->RecordChanges(BLOCK_REFERRERS_CHANGED);
+}
+
 // Returns true if this block contains the given range of bytes.
 bool BlockGraph::Block::Contains(RelativeAddress address, size_t size) const {
   return (address >= addr_ && address + size <= addr_ + size_);
@@ -33,12 +33,22 @@
         'block_builder.h',
         'block_graph.cc',
         'block_graph.h',
+        'block_graph_arena.cc',
+        'block_graph_arena.h',
+        'block_graph_journal.cc',
+        'block_graph_journal.h',
         'block_graph_serializer.cc',
         'block_graph_serializer.h',
         'block_hash.cc',
         'block_hash.h',
+        'block_hash_index.cc',
+        'block_hash_index.h',
+        'block_transform_cache.cc',
+        'block_transform_cache.h',
         'block_util.cc',
         'block_util.h',
+        'decoded_instruction_cache.cc',
+        'decoded_instruction_cache.h',
         'filter_util.cc',
         'filter_util.h',
         'filterable.cc',
@@ -46,11 +56,14 @@
         'hot_patching_metadata.h',
         'iterate.cc',
         'iterate.h',
+        'iterate_impl.h',
         'ordered_block_graph.cc',
         'ordered_block_graph.h',
         'ordered_block_graph_internal.h',
         'orderer.cc',
         'orderer.h',
+        'parallel_basic_block_decomposer.cc',
+        'parallel_basic_block_decomposer.h',
         'tags.h',
         'transform.cc',
         'transform.h',
@@ -93,14 +106,20 @@
         'basic_block_subgraph_unittest.cc',
         'block_graph_serializer_unittest.cc',
         'block_builder_unittest.cc',
+        'block_graph_arena_unittest.cc',
+        'block_graph_journal_unittest.cc',
         'block_graph_unittest.cc',
+        'block_hash_index_unittest.cc',
         'block_hash_unittest.cc',
+        'block_transform_cache_unittest.cc',
         'block_util_unittest.cc',
+        'decoded_instruction_cache_unittest.cc',
         'filter_util_unittest.cc',
         'filterable_unittest.cc',
         'iterate_unittest.cc',
         'ordered_block_graph_unittest.cc',
         'orderer_unittest.cc',
+        'parallel_basic_block_decomposer_unittest.cc',
         'transform_unittest.cc',
         'typed_block_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
@@ -25,6 +25,7 @@
 #define SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_H_
 
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -32,6 +33,7 @@
 
 #include "base/files/file_util.h"
 #include "base/strings/string_piece.h"
+#include "syzygy/block_graph/block_graph_arena.h"
 #include "syzygy/common/align.h"
 #include "syzygy/core/address.h"
 #include "syzygy/core/address_space.h"
@@ -39,7 +41,8 @@
 
 namespace block_graph {
 
-// Forward declaration.
+// Forward declarations.
+class BlockGraphJournal;
 class BlockGraphSerializer;
 
 // NOTE: When adding attributes be sure to update any uses of them in
@@ -234,6 +237,22 @@ class BlockGraph {
     REFERENCE_TYPE_MAX,
   };
 
+  // The changes to a block that are recorded by a BlockGraphJournal.
+  enum BlockChangesEnum {
+    // The data of the block changed.
+    BLOCK_DATA_CHANGED = (1 << 0),
+    // References were added to, removed from or changed in the block.
+    BLOCK_REFERENCES_CHANGED = (1 << 1),
+    // References to the block were added, removed or changed.
+    BLOCK_REFERRERS_CHANGED = (1 << 2),
+    // Labels were added to or removed from the block.
+    BLOCK_LABELS_CHANGED = (1 << 3),
+    // The type, size, alignment, padding, name, section or attributes of the
+    // block changed.
+    BLOCK_PROPERTIES_CHANGED = (1 << 4),
+  };
+  typedef uint32_t BlockChanges;
+
   // Forward declarations.
   class AddressSpace;
   class Block;
@@ -242,7 +261,9 @@ class BlockGraph {
   struct BlockIdLess;
 
   // The block map contains all blocks, indexed by id.
-  typedef std::map<BlockId, Block> BlockMap;
+  typedef std::map<BlockId, Block, std::less<BlockId>,
+                   BlockGraphAllocator<std::pair<const BlockId, Block>>>
+      BlockMap;
 
   BlockGraph();
   ~BlockGraph();
@@ -346,6 +367,16 @@ class BlockGraph {
   // @returns the string table of this BlockGraph.
   core::StringTable& string_table() { return string_table_; }
 
+  // Switches the block graph to arena storage: its blocks, along with their
+  // references, referrers and labels, are then allocated from an arena owned
+  // by the block graph rather than individually from the heap. This only
+  // changes the memory footprint of the block graph, not its behaviour.
+  // @pre The block graph has no blocks.
+  void EnableArenaStorage();
+  // @returns the arena of this block graph, or NULL if it doesn't use arena
+  //     storage.
+  BlockGraphArena* arena() const { return arena_.get(); }
+
   // Sets the image format.
   // @param image_format The format of the image.
   void set_image_format(ImageFormat image_format) {
@@ -354,6 +385,14 @@ class BlockGraph {
   // @returns the image format.
   ImageFormat image_format() const { return image_format_; }
 
+  // Attaches a change journal to the block graph, which then records the
+  // blocks that are added, removed and changed.
+  // @param journal The journal to attach, or NULL to detach the current one.
+  //     The journal must remain valid for as long as it is attached.
+  void set_journal(BlockGraphJournal* journal) { journal_ = journal; }
+  // @returns the attached change journal, or NULL if there is none.
+  BlockGraphJournal* journal() const { return journal_; }
+
  private:
   // Give BlockGraphSerializer access to our innards for serialization.
   friend BlockGraphSerializer;
@@ -361,12 +400,24 @@ class BlockGraph {
   // Removes a block by the iterator to it. The iterator must be valid.
   bool RemoveBlockByIterator(BlockMap::iterator it);
 
+  // Records changes to a block in the attached journal, if any. This is
+  // inline so that the common case, without a journal, stays cheap.
+  void RecordBlockChanges(BlockId id, BlockChanges changes) {
+    if (journal_ != NULL)
+      RecordBlockChangesImpl(id, changes);
+  }
+  void RecordBlockChangesImpl(BlockId id, BlockChanges changes);
+
   // All sections we contain.
   SectionMap sections_;
 
   // Our section ID allocator.
   SectionId next_section_id_;
 
+  // The arena the blocks are allocated from, if any. This must outlive the
+  // blocks.
+  std::unique_ptr<BlockGraphArena> arena_;
+
   // All blocks we contain.
   BlockMap blocks_;
 
@@ -380,6 +431,9 @@ class BlockGraph {
   // UNKNOWN_IMAGE_FORMAT. Usually initialized by the appropriate decomposer.
   ImageFormat image_format_;
 
+  // The attached change journal, if any. Not owned.
+  BlockGraphJournal* journal_;
+
   DISALLOW_COPY_AND_ASSIGN(BlockGraph);
 };
 
@@ -559,10 +613,13 @@ class BlockGraph::Block {
   // to allow one to easily locate and remove the backreferences on change or
   // deletion.
   typedef std::pair<Block*, Offset> Referrer;
-  typedef std::set<Referrer> ReferrerSet;
+  typedef std::set<Referrer, std::less<Referrer>,
+                   BlockGraphAllocator<Referrer>> ReferrerSet;
 
   // Map of references that this block makes to other blocks.
-  typedef std::map<Offset, Reference> ReferenceMap;
+  typedef std::map<Offset, Reference, std::less<Offset>,
+                   BlockGraphAllocator<std::pair<const Offset, Reference>>>
+      ReferenceMap;
 
   // Represents a range of data in this block.
   typedef core::AddressRange<Offset, Size> DataRange;
@@ -573,6 +630,10 @@ class BlockGraph::Block {
   // A map between bytes in this block and bytes in the original image.
   typedef core::AddressRangeMap<DataRange, SourceRange> SourceRanges;
 
+  // Collects the mappings of a SourceRanges, to build it in one pass.
+  typedef core::AddressRangeMapBuilder<DataRange, SourceRange>
+      SourceRangesBuilder;
+
   // The flags that can be passed to the TransferReferrers function.
   enum TransferReferrersFlags {
     kSkipInternalReferences = (1 << 0),
@@ -585,14 +646,30 @@ class BlockGraph::Block {
   // within the block. Note that, while possible, it is NOT guaranteed that
   // all basic blocks are marked with a label. Basic block decomposition should
   // disassemble from the code labels to discover all basic blocks.
-  typedef std::map<Offset, Label> LabelMap;
+  typedef std::map<Offset, Label, std::less<Offset>,
+                   BlockGraphAllocator<std::pair<const Offset, Label>>>
+      LabelMap;
+
+  // Copies a block. Unlike copies of the containers themselves, the copied
+  // references, referrers and labels are allocated like the original ones.
+  // This is what blocks are inserted in the block map with.
+  Block(const Block& other);
 
   ~Block();
 
   // Accessors.
   BlockId id() const { return id_; }
   BlockType type() const { return type_; }
-  void set_type(BlockType type) { type_ = type; }
+
+  // @returns the number of changes recorded to this block. Together with the
+  //     block ID this identifies a version of the block, so that decisions
+  //     derived from its contents can be cached and invalidated when it
+  //     changes. This counts changes whether or not a journal is attached.
+  uint32_t change_count() const { return change_count_; }
+  void set_type(BlockType type) {
+    type_ = type;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
+  }
 
   Size size() const { return size_; }
 
@@ -601,6 +678,7 @@ class BlockGraph::Block {
   void set_size(Size size) {
     DCHECK_LE(data_size_, size);
     size_ = size;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
   }
 
   const std::string& name() const {
@@ -625,6 +703,7 @@ class BlockGraph::Block {
     // Ensure that alignment is a non-zero power of two.
     DCHECK(common::IsPowerOfTwo(alignment));
     alignment_ = alignment;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
   }
 
   // Gets the offset the alignment is applied to.
@@ -636,6 +715,7 @@ class BlockGraph::Block {
   // @param alignment_offset The new offset of the alignment.
   void set_alignment_offset(Offset alignment_offset) {
     alignment_offset_ = alignment_offset;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
   }
 
   // Returns the minimum amount of padding bytes that are inserted before the
@@ -648,6 +728,7 @@ class BlockGraph::Block {
   //     the block when building the layout.
   void set_padding_before(Size padding_before) {
     padding_before_ = padding_before;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
   }
 
   // The address of the block is set any time the block is assigned
@@ -658,17 +739,27 @@ class BlockGraph::Block {
   // The section ID for the block. These IDs are wrt to the SectionMap in the
   // parent BlockGraph.
   SectionId section() const { return section_; }
-  void set_section(SectionId section) { section_ = section; }
+  void set_section(SectionId section) {
+    section_ = section;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
+  }
 
   // The block attributes are a bitmask. You can set them wholesale,
   // or set and clear them individually by bitmasking.
   BlockAttributes attributes() const { return attributes_; }
-  void set_attributes(BlockAttributes attributes) { attributes_ = attributes; }
+  void set_attributes(BlockAttributes attributes) {
+    attributes_ = attributes;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
+  }
 
   // Set or clear one or more attributes.
-  void set_attribute(BlockAttributes attribute) { attributes_ |= attribute; }
+  void set_attribute(BlockAttributes attribute) {
+    attributes_ |= attribute;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
+  }
   void clear_attribute(BlockAttributes attribute) {
     attributes_ &= ~attribute;
+    RecordChanges(BLOCK_PROPERTIES_CHANGED);
   }
 
   // This is true iff data_ is in the ownership of the block.
@@ -855,6 +946,18 @@ class BlockGraph::Block {
   // data buffer will not have been initialized in any way.
   uint8_t* AllocateRawData(size_t size);
 
+  // Records changes to this block in the journal of its block graph, if any.
+  void RecordChanges(BlockChanges changes) {
+    DCHECK(block_graph_ != NULL);
+    ++change_count_;
+    block_graph_->RecordBlockChanges(id_, changes);
+  }
+
+  // Records the changes to the blocks connected to this one when its content
+  // is shifted by InsertData or RemoveData: the references held by its
+  // referrers, and the referrers of the blocks it references.
+  void RecordShiftChanges();
+
   BlockId id_;
   BlockType type_;
   Size size_;
@@ -884,6 +987,8 @@ class BlockGraph::Block {
   const uint8_t* data_;
   // Size of the above.
   size_t data_size_;
+  // The number of changes recorded to this block.
+  uint32_t change_count_;
 };
 
 // Less-than comparator for blocks. Useful to keep ordered set stable.
@@ -979,6 +1084,12 @@ class BlockGraph::AddressSpace {
   //     address space.
   bool GetAddressOf(const Block* block, RelativeAddress* addr) const;
 
+  // Freezes the underlying address space for a read-mostly phase, speeding
+  // up the lookup of blocks by address. Adding, removing or resizing blocks
+  // thaws it again. @see core::AddressSpace::Freeze.
+  void Freeze() { address_space_.Freeze(); }
+  void Thaw() { address_space_.Thaw(); }
+
   // Accessor.
   BlockGraph* graph() { return graph_; }
   const BlockGraph* graph() const { return graph_; }
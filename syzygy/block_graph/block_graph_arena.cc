@@ -0,0 +1,77 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_graph_arena.h"
+
+#include <string.h>
+
+namespace block_graph {
+
+const size_t BlockGraphArena::kGranularity;
+const size_t BlockGraphArena::kMaxSize;
+const size_t BlockGraphArena::kChunkSize;
+
+BlockGraphArena::BlockGraphArena()
+    : cursor_(nullptr), end_(nullptr), allocated_bytes_(0) {
+  ::memset(free_lists_, 0, sizeof(free_lists_));
+}
+
+BlockGraphArena::~BlockGraphArena() {
+}
+
+void* BlockGraphArena::Allocate(size_t size) {
+  if (size > kMaxSize)
+    return ::operator new(size);
+
+  size_t size_class = GetSizeClass(size);
+  size_t rounded_size = size_class * kGranularity;
+  allocated_bytes_ += rounded_size;
+
+  // Recycle a freed allocation of the same size class if there is one.
+  FreeNode* node = free_lists_[size_class];
+  if (node != nullptr) {
+    free_lists_[size_class] = node->next;
+    return node;
+  }
+
+  // Otherwise carve the allocation out of the current chunk, starting a new
+  // one if need be. The tail of the previous chunk is simply abandoned.
+  if (static_cast<size_t>(end_ - cursor_) < rounded_size) {
+    chunks_.push_back(std::unique_ptr<uint8_t[]>(new uint8_t[kChunkSize]));
+    cursor_ = chunks_.back().get();
+    end_ = cursor_ + kChunkSize;
+  }
+  void* ptr = cursor_;
+  cursor_ += rounded_size;
+  return ptr;
+}
+
+void BlockGraphArena::Free(void* ptr, size_t size) {
+  DCHECK_NE(static_cast<void*>(nullptr), ptr);
+
+  if (size > kMaxSize) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  size_t size_class = GetSizeClass(size);
+  DCHECK_LE(size_class * kGranularity, allocated_bytes_);
+  allocated_bytes_ -= size_class * kGranularity;
+
+  FreeNode* node = static_cast<FreeNode*>(ptr);
+  node->next = free_lists_[size_class];
+  free_lists_[size_class] = node;
+}
+
+}  // namespace block_graph
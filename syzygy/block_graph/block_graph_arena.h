@@ -0,0 +1,171 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares an arena from which the nodes of the containers of a block graph
+// can be allocated, and the STL allocator that draws from it.
+//
+// A decomposed image holds tens of millions of references, referrers and
+// labels, each of which lives in a node of its own. Carving these nodes out
+// of large chunks rather than allocating them individually on the heap saves
+// the per-allocation overhead of the heap and keeps the nodes of neighbouring
+// blocks close together in memory. Freed nodes are recycled through a free
+// list per size class, and the chunks are only returned to the heap when the
+// arena is destroyed.
+//
+// The arena isn't thread-safe, just like the containers that draw from it.
+
+#ifndef SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_ARENA_H_
+#define SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_ARENA_H_
+
+#include <stdint.h>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+
+namespace block_graph {
+
+class BlockGraphArena {
+ public:
+  // The granularity of the size classes, and their alignment.
+  static const size_t kGranularity = 8;
+  // Allocations larger than this are served by the heap.
+  static const size_t kMaxSize = 256;
+  // The size of the chunks that the arena carves its allocations from.
+  static const size_t kChunkSize = 64 * 1024;
+
+  BlockGraphArena();
+  ~BlockGraphArena();
+
+  // Allocates memory from the arena.
+  // @param size The size of the allocation.
+  // @returns the allocated memory, aligned to kGranularity.
+  void* Allocate(size_t size);
+
+  // Returns memory to the arena.
+  // @param ptr The memory to free, as returned by Allocate.
+  // @param size The size that @p ptr was allocated with.
+  void Free(void* ptr, size_t size);
+
+  // @name Accessors.
+  // @{
+  // @returns the number of bytes reserved by the arena from the heap.
+  size_t reserved_bytes() const { return chunks_.size() * kChunkSize; }
+  // @returns the number of bytes currently allocated from the arena chunks.
+  size_t allocated_bytes() const { return allocated_bytes_; }
+  // @}
+
+ private:
+  // A freed allocation, linking to the next one of its size class.
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  // @returns the size class of allocations of @p size bytes.
+  static size_t GetSizeClass(size_t size) {
+    DCHECK_LT(0u, size);
+    DCHECK_GE(kMaxSize, size);
+    return (size + kGranularity - 1) / kGranularity;
+  }
+
+  // The chunks owned by the arena.
+  std::vector<std::unique_ptr<uint8_t[]>> chunks_;
+
+  // The unused part of the current chunk.
+  uint8_t* cursor_;
+  uint8_t* end_;
+
+  // The free lists, indexed by size class.
+  FreeNode* free_lists_[kMaxSize / kGranularity + 1];
+
+  size_t allocated_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockGraphArena);
+};
+
+// An STL allocator drawing single elements from a BlockGraphArena. Arrays,
+// and all allocations of default-constructed allocators, are served by the
+// heap.
+//
+// The arena travels along with the nodes when containers are moved or
+// swapped. Copies of a container, however, are allocated from the heap, so
+// that they may outlive the arena and be used on other threads.
+template <typename T>
+class BlockGraphAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  typedef std::false_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  template <typename U>
+  struct rebind {
+    typedef BlockGraphAllocator<U> other;
+  };
+
+  BlockGraphAllocator() : arena_(nullptr) {}
+  explicit BlockGraphAllocator(BlockGraphArena* arena) : arena_(arena) {}
+  template <typename U>
+  BlockGraphAllocator(const BlockGraphAllocator<U>& other)  // NOLINT
+      : arena_(other.arena()) {}
+
+  T* allocate(size_t count) {
+    if (arena_ == nullptr || count != 1)
+      return static_cast<T*>(::operator new(count * sizeof(T)));
+    return static_cast<T*>(arena_->Allocate(sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t count) {
+    if (arena_ == nullptr || count != 1) {
+      ::operator delete(ptr);
+      return;
+    }
+    arena_->Free(ptr, sizeof(T));
+  }
+
+  BlockGraphAllocator select_on_container_copy_construction() const {
+    return BlockGraphAllocator();
+  }
+
+  // @returns the arena this allocator draws from, or NULL for the heap.
+  BlockGraphArena* arena() const { return arena_; }
+
+ private:
+  BlockGraphArena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const BlockGraphAllocator<T>& a,
+                const BlockGraphAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const BlockGraphAllocator<T>& a,
+                const BlockGraphAllocator<U>& b) {
+  return !(a == b);
+}
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_ARENA_H_
@@ -0,0 +1,97 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_graph_arena.h"
+
+#include <map>
+#include <utility>
+
+#include "gtest/gtest.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef std::map<int, int, std::less<int>,
+                 BlockGraphAllocator<std::pair<const int, int>>> ArenaMap;
+
+}  // namespace
+
+TEST(BlockGraphArenaTest, AllocateAndFree) {
+  BlockGraphArena arena;
+  EXPECT_EQ(0u, arena.reserved_bytes());
+  EXPECT_EQ(0u, arena.allocated_bytes());
+
+  void* a = arena.Allocate(12);
+  void* b = arena.Allocate(16);
+  ASSERT_TRUE(a != NULL);
+  ASSERT_TRUE(b != NULL);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(a) %
+                BlockGraphArena::kGranularity);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(b) %
+                BlockGraphArena::kGranularity);
+  EXPECT_EQ(BlockGraphArena::kChunkSize, arena.reserved_bytes());
+  EXPECT_EQ(32u, arena.allocated_bytes());
+
+  // Freed allocations are recycled within their size class.
+  arena.Free(a, 12);
+  EXPECT_EQ(16u, arena.allocated_bytes());
+  EXPECT_EQ(a, arena.Allocate(16));
+  EXPECT_NE(b, arena.Allocate(16));
+
+  // Large allocations are served by the heap.
+  void* large = arena.Allocate(BlockGraphArena::kMaxSize + 1);
+  ASSERT_TRUE(large != NULL);
+  EXPECT_EQ(48u, arena.allocated_bytes());
+  arena.Free(large, BlockGraphArena::kMaxSize + 1);
+}
+
+TEST(BlockGraphArenaTest, NewChunks) {
+  BlockGraphArena arena;
+  size_t count = BlockGraphArena::kChunkSize / BlockGraphArena::kMaxSize;
+  for (size_t i = 0; i < count + 1; ++i)
+    ASSERT_TRUE(arena.Allocate(BlockGraphArena::kMaxSize) != NULL);
+  EXPECT_EQ(2 * BlockGraphArena::kChunkSize, arena.reserved_bytes());
+}
+
+TEST(BlockGraphAllocatorTest, Containers) {
+  BlockGraphArena arena;
+  ArenaMap::allocator_type allocator(&arena);
+  ArenaMap map(allocator);
+  for (int i = 0; i < 100; ++i)
+    map.insert(std::make_pair(i, i));
+  EXPECT_LT(0u, arena.allocated_bytes());
+
+  // Copies are allocated from the heap.
+  ArenaMap copy(map);
+  EXPECT_EQ(map, copy);
+  EXPECT_TRUE(copy.get_allocator().arena() == NULL);
+
+  // Moves keep the arena.
+  ArenaMap moved(std::move(map));
+  EXPECT_EQ(&arena, moved.get_allocator().arena());
+  EXPECT_EQ(copy, moved);
+
+  // Copy assignment keeps the allocator of the destination.
+  ArenaMap heap_map;
+  heap_map = moved;
+  EXPECT_TRUE(heap_map.get_allocator().arena() == NULL);
+  EXPECT_EQ(moved, heap_map);
+
+  moved.clear();
+  EXPECT_EQ(0u, arena.allocated_bytes());
+}
+
+}  // namespace block_graph
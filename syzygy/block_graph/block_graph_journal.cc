@@ -0,0 +1,118 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_graph_journal.h"
+
+#include "base/logging.h"
+
+namespace block_graph {
+
+BlockGraphJournal::BlockGraphJournal() {
+}
+
+BlockGraphJournal::~BlockGraphJournal() {
+}
+
+void BlockGraphJournal::BeginChangeSet(const base::StringPiece& name) {
+  change_sets_.push_back(ChangeSet());
+  name.CopyToString(&change_sets_.back().name);
+}
+
+void BlockGraphJournal::GetCumulativeChanges(ChangeSet* changes) const {
+  DCHECK(changes != NULL);
+
+  *changes = ChangeSet();
+
+  // Replay the change sets in order. Within a change set a block is added
+  // before it is changed, and changed before it is removed, so replaying each
+  // kind of change in that order is faithful.
+  ChangeSets::const_iterator set_it = change_sets_.begin();
+  for (; set_it != change_sets_.end(); ++set_it) {
+    BlockIdSet::const_iterator it = set_it->added_blocks.begin();
+    for (; it != set_it->added_blocks.end(); ++it)
+      AddBlock(*it, changes);
+
+    BlockChangesMap::const_iterator changed_it =
+        set_it->changed_blocks.begin();
+    for (; changed_it != set_it->changed_blocks.end(); ++changed_it)
+      ChangeBlock(changed_it->first, changed_it->second, changes);
+
+    it = set_it->removed_blocks.begin();
+    for (; it != set_it->removed_blocks.end(); ++it)
+      RemoveBlock(*it, changes);
+  }
+}
+
+void BlockGraphJournal::RecordBlockAdded(BlockId id) {
+  AddBlock(id, GetCurrentChangeSet());
+}
+
+void BlockGraphJournal::RecordBlockRemoved(BlockId id) {
+  RemoveBlock(id, GetCurrentChangeSet());
+}
+
+void BlockGraphJournal::RecordBlockChanges(BlockId id, BlockChanges changes) {
+  ChangeBlock(id, changes, GetCurrentChangeSet());
+}
+
+void BlockGraphJournal::AddBlock(BlockId id, ChangeSet* change_set) {
+  DCHECK(change_set != NULL);
+  bool inserted = change_set->added_blocks.insert(id).second;
+  DCHECK(inserted);
+}
+
+void BlockGraphJournal::RemoveBlock(BlockId id, ChangeSet* change_set) {
+  DCHECK(change_set != NULL);
+
+  // A block that was added and then removed leaves no trace.
+  if (change_set->added_blocks.erase(id) != 0)
+    return;
+
+  change_set->changed_blocks.erase(id);
+  change_set->removed_blocks.insert(id);
+}
+
+void BlockGraphJournal::ChangeBlock(BlockId id,
+                                    BlockChanges changes,
+                                    ChangeSet* change_set) {
+  DCHECK(change_set != NULL);
+  DCHECK_EQ(0U, change_set->removed_blocks.count(id));
+
+  // Changes to a block that was added are implied.
+  if (change_set->added_blocks.count(id) != 0)
+    return;
+
+  change_set->changed_blocks[id] |= changes;
+}
+
+BlockGraphJournal::ChangeSet* BlockGraphJournal::GetCurrentChangeSet() {
+  if (change_sets_.empty())
+    change_sets_.push_back(ChangeSet());
+  return &change_sets_.back();
+}
+
+ScopedBlockGraphJournal::ScopedBlockGraphJournal(BlockGraph* block_graph,
+                                                 BlockGraphJournal* journal)
+    : block_graph_(block_graph) {
+  DCHECK(block_graph != NULL);
+  DCHECK(journal != NULL);
+  DCHECK(block_graph->journal() == NULL);
+  block_graph->set_journal(journal);
+}
+
+ScopedBlockGraphJournal::~ScopedBlockGraphJournal() {
+  block_graph_->set_journal(NULL);
+}
+
+}  // namespace block_graph
@@ -0,0 +1,131 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a journal of the changes made to a block graph. Once attached to a
+// block graph, the journal records which blocks are added, removed and
+// changed, grouped in change sets. ApplyBlockGraphTransform starts a change
+// set per transform, so that stages downstream of the transforms can tell
+// which blocks each transform touched and recompute only what depends on
+// them.
+//
+// The journal only records block IDs, which the block graph never reuses, so
+// it can be consulted after the blocks themselves are gone.
+
+#ifndef SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_JOURNAL_H_
+#define SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_JOURNAL_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/strings/string_piece.h"
+#include "syzygy/block_graph/block_graph.h"
+
+namespace block_graph {
+
+class BlockGraphJournal {
+ public:
+  typedef BlockGraph::BlockId BlockId;
+  typedef BlockGraph::BlockChanges BlockChanges;
+  typedef std::set<BlockId> BlockIdSet;
+  typedef std::map<BlockId, BlockChanges> BlockChangesMap;
+
+  // The changes made to a block graph over some period.
+  struct ChangeSet {
+    // @returns true if no change was recorded.
+    bool empty() const {
+      return added_blocks.empty() && removed_blocks.empty() &&
+          changed_blocks.empty();
+    }
+
+    // The name of the change set, usually that of the transform that made the
+    // changes.
+    std::string name;
+    // The blocks that were added, and still exist.
+    BlockIdSet added_blocks;
+    // The pre-existing blocks that were removed.
+    BlockIdSet removed_blocks;
+    // The pre-existing blocks that were changed and still exist, with the
+    // changes made to them. This is a mask of BlockGraph::BlockChangesEnum
+    // values.
+    BlockChangesMap changed_blocks;
+  };
+  typedef std::vector<ChangeSet> ChangeSets;
+
+  BlockGraphJournal();
+  ~BlockGraphJournal();
+
+  // Starts a new change set. The changes recorded from now on go to it. The
+  // changes recorded before the first change set is started go to an unnamed
+  // one.
+  // @param name The name of the change set.
+  void BeginChangeSet(const base::StringPiece& name);
+
+  // Discards all of the recorded changes.
+  void Clear() { change_sets_.clear(); }
+
+  // Gets the changes recorded over all of the change sets.
+  // @param changes Receives the combined changes. Its name is left empty.
+  void GetCumulativeChanges(ChangeSet* changes) const;
+
+  // @name Recording functions. These are called by the block graph that the
+  //     journal is attached to.
+  // @{
+  void RecordBlockAdded(BlockId id);
+  void RecordBlockRemoved(BlockId id);
+  void RecordBlockChanges(BlockId id, BlockChanges changes);
+  // @}
+
+  // @name Accessors.
+  // @{
+  const ChangeSets& change_sets() const { return change_sets_; }
+  // @}
+
+ protected:
+  // Applies a change to a change set.
+  static void AddBlock(BlockId id, ChangeSet* change_set);
+  static void RemoveBlock(BlockId id, ChangeSet* change_set);
+  static void ChangeBlock(BlockId id,
+                          BlockChanges changes,
+                          ChangeSet* change_set);
+
+  // @returns the change set to record changes to, starting one if needed.
+  ChangeSet* GetCurrentChangeSet();
+
+  // The change sets, in the order they were started.
+  ChangeSets change_sets_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BlockGraphJournal);
+};
+
+// Attaches a journal to a block graph for the lifetime of this object.
+class ScopedBlockGraphJournal {
+ public:
+  // @param block_graph The block graph to attach @p journal to. This must not
+  //     have a journal attached already.
+  // @param journal The journal to attach.
+  ScopedBlockGraphJournal(BlockGraph* block_graph, BlockGraphJournal* journal);
+  ~ScopedBlockGraphJournal();
+
+ private:
+  BlockGraph* block_graph_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedBlockGraphJournal);
+};
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_BLOCK_GRAPH_JOURNAL_H_
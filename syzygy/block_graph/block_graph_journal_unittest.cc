@@ -0,0 +1,172 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_graph_journal.h"
+
+#include "gtest/gtest.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef BlockGraphJournal::ChangeSet ChangeSet;
+
+class BlockGraphJournalTest : public testing::Test {
+ public:
+  BlockGraphJournalTest() : block0_(NULL), block1_(NULL) {
+  }
+
+  virtual void SetUp() override {
+    block0_ = block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 16, "block0");
+    block1_ = block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 16, "block1");
+  }
+
+  // @returns the changes recorded for @p block in @p change_set.
+  static BlockGraph::BlockChanges GetChanges(const ChangeSet& change_set,
+                                             const BlockGraph::Block* block) {
+    BlockGraphJournal::BlockChangesMap::const_iterator it =
+        change_set.changed_blocks.find(block->id());
+    if (it == change_set.changed_blocks.end())
+      return 0;
+    return it->second;
+  }
+
+  BlockGraph block_graph_;
+  BlockGraph::Block* block0_;
+  BlockGraph::Block* block1_;
+};
+
+}  // namespace
+
+TEST_F(BlockGraphJournalTest, NothingIsRecordedWithoutJournal) {
+  BlockGraphJournal journal;
+  block0_->set_size(32);
+  block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "block2");
+  EXPECT_TRUE(journal.change_sets().empty());
+  EXPECT_TRUE(block_graph_.journal() == NULL);
+}
+
+TEST_F(BlockGraphJournalTest, RecordsAddedAndRemovedBlocks) {
+  BlockGraphJournal journal;
+  {
+    ScopedBlockGraphJournal scoped_journal(&block_graph_, &journal);
+    EXPECT_EQ(&journal, block_graph_.journal());
+
+    BlockGraph::Block* block2 =
+        block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "block2");
+    BlockGraph::Block* block3 =
+        block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "block3");
+    BlockGraph::BlockId block1_id = block1_->id();
+    EXPECT_TRUE(block_graph_.RemoveBlock(block1_));
+
+    // Changes to an added block are implied, and a block that is added then
+    // removed leaves no trace.
+    block2->set_size(8);
+    EXPECT_TRUE(block_graph_.RemoveBlock(block3));
+
+    ASSERT_EQ(1u, journal.change_sets().size());
+    const ChangeSet& change_set = journal.change_sets()[0];
+    EXPECT_TRUE(change_set.name.empty());
+    EXPECT_EQ(BlockGraphJournal::BlockIdSet({ block2->id() }),
+              change_set.added_blocks);
+    EXPECT_EQ(BlockGraphJournal::BlockIdSet({ block1_id }),
+              change_set.removed_blocks);
+    EXPECT_TRUE(change_set.changed_blocks.empty());
+  }
+  EXPECT_TRUE(block_graph_.journal() == NULL);
+}
+
+TEST_F(BlockGraphJournalTest, RecordsBlockChanges) {
+  BlockGraphJournal journal;
+  ScopedBlockGraphJournal scoped_journal(&block_graph_, &journal);
+
+  block0_->set_alignment(4);
+  block0_->SetLabel(0, "label", BlockGraph::CODE_LABEL);
+  block0_->AllocateData(16);
+  const ChangeSet& change_set = journal.change_sets().back();
+  EXPECT_EQ(BlockGraph::BLOCK_PROPERTIES_CHANGED |
+                BlockGraph::BLOCK_LABELS_CHANGED |
+                BlockGraph::BLOCK_DATA_CHANGED,
+            GetChanges(change_set, block0_));
+  EXPECT_EQ(0u, GetChanges(change_set, block1_));
+
+  // A reference changes both of the blocks it connects.
+  journal.Clear();
+  BlockGraph::Reference ref(BlockGraph::ABSOLUTE_REF, 4, block1_, 0, 0);
+  EXPECT_TRUE(block0_->SetReference(0, ref));
+  EXPECT_EQ(BlockGraph::BLOCK_REFERENCES_CHANGED,
+            GetChanges(journal.change_sets().back(), block0_));
+  EXPECT_EQ(BlockGraph::BLOCK_REFERRERS_CHANGED,
+            GetChanges(journal.change_sets().back(), block1_));
+
+  // Inserting data into a block shifts the references to it.
+  journal.Clear();
+  block1_->InsertData(0, 4, false);
+  EXPECT_EQ(BlockGraph::BLOCK_REFERENCES_CHANGED,
+            GetChanges(journal.change_sets().back(), block0_));
+  EXPECT_NE(0u, GetChanges(journal.change_sets().back(), block1_) &
+                BlockGraph::BLOCK_PROPERTIES_CHANGED);
+
+  journal.Clear();
+  EXPECT_TRUE(block0_->RemoveReference(0));
+  EXPECT_EQ(BlockGraph::BLOCK_REFERENCES_CHANGED,
+            GetChanges(journal.change_sets().back(), block0_));
+  EXPECT_EQ(BlockGraph::BLOCK_REFERRERS_CHANGED,
+            GetChanges(journal.change_sets().back(), block1_));
+}
+
+TEST_F(BlockGraphJournalTest, ChangeSets) {
+  BlockGraphJournal journal;
+  ScopedBlockGraphJournal scoped_journal(&block_graph_, &journal);
+
+  journal.BeginChangeSet("first");
+  BlockGraph::Block* block2 =
+      block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "block2");
+  block0_->set_attribute(BlockGraph::PADDING_BLOCK);
+
+  journal.BeginChangeSet("second");
+  block2->set_size(8);
+  block1_->set_section(0);
+  BlockGraph::BlockId block0_id = block0_->id();
+  EXPECT_TRUE(block_graph_.RemoveBlock(block0_));
+
+  ASSERT_EQ(2u, journal.change_sets().size());
+  const ChangeSet& first = journal.change_sets()[0];
+  EXPECT_EQ("first", first.name);
+  EXPECT_EQ(1u, first.added_blocks.size());
+  EXPECT_EQ(BlockGraph::BLOCK_PROPERTIES_CHANGED, first.changed_blocks.at(
+      block0_id));
+
+  // The second change set sees the block added by the first as changed.
+  const ChangeSet& second = journal.change_sets()[1];
+  EXPECT_EQ("second", second.name);
+  EXPECT_TRUE(second.added_blocks.empty());
+  EXPECT_EQ(BlockGraphJournal::BlockIdSet({ block0_id }),
+            second.removed_blocks);
+  EXPECT_EQ(2u, second.changed_blocks.size());
+  EXPECT_EQ(BlockGraph::BLOCK_PROPERTIES_CHANGED, GetChanges(second, block2));
+
+  // Cumulatively, the block added by the first is simply added, and the block
+  // changed by the first then removed by the second is removed.
+  ChangeSet changes;
+  journal.GetCumulativeChanges(&changes);
+  EXPECT_EQ(BlockGraphJournal::BlockIdSet({ block2->id() }),
+            changes.added_blocks);
+  EXPECT_EQ(BlockGraphJournal::BlockIdSet({ block0_id }),
+            changes.removed_blocks);
+  ASSERT_EQ(1u, changes.changed_blocks.size());
+  EXPECT_EQ(BlockGraph::BLOCK_PROPERTIES_CHANGED, GetChanges(changes, block1_));
+}
+
+}  // namespace block_graph
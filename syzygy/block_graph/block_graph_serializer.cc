@@ -639,14 +639,23 @@ bool BlockGraphSerializer::LoadBlockData(BlockGraph::Block* block,
   if (data_in_stream) {
     DCHECK_LT(0u, data_size);
 
-    // Read the data from the stream.
-    block->AllocateData(data_size);
-    DCHECK_EQ(data_size, block->data_size());
-    DCHECK(block->data() != NULL);
-    if (!in_archive->in_stream()->Read(data_size, block->GetMutableData())) {
-      LOG(ERROR) << "Unable to read data for block with id "
-                 << block->id() << ".";
-      return false;
+    // Reference the data in place if we can. The block takes a copy of it as
+    // soon as it's modified.
+    const uint8_t* data = NULL;
+    if (load_data_in_place_ &&
+        in_archive->in_stream()->ReadInPlace(data_size, &data)) {
+      block->SetData(data, data_size);
+    } else {
+      // Read the data from the stream.
+      block->AllocateData(data_size);
+      DCHECK_EQ(data_size, block->data_size());
+      DCHECK(block->data() != NULL);
+      if (!in_archive->in_stream()->Read(data_size,
+                                         block->GetMutableData())) {
+        LOG(ERROR) << "Unable to read data for block with id "
+                   << block->id() << ".";
+        return false;
+      }
     }
   }
 
@@ -131,7 +131,8 @@ class BlockGraphSerializer {
 
   // Default constructor.
   BlockGraphSerializer()
-      : data_mode_(DEFAULT_DATA_MODE), attributes_(DEFAULT_ATTRIBUTES) { }
+      : data_mode_(DEFAULT_DATA_MODE), attributes_(DEFAULT_ATTRIBUTES),
+        load_data_in_place_(false) { }
 
   // @name For setting and accessing the data mode.
   // @{
@@ -193,6 +194,20 @@ class BlockGraphSerializer {
         new LoadBlockDataCallback(load_block_data_callback));
   }
 
+  // @name For controlling whether block data is loaded in place.
+  // @{
+  // When set, the data of the blocks that is serialized explicitly is
+  // referenced in place by the loaded blocks rather than copied to them,
+  // whenever the input stream supports it (@see core::InStream::ReadInPlace).
+  // This is meant for reloading block-graphs from memory-mapped files. The
+  // memory backing the stream must then outlive the loaded block-graph, or at
+  // least the unmodified data of its blocks.
+  bool load_data_in_place() const { return load_data_in_place_; }
+  void set_load_data_in_place(bool load_data_in_place) {
+    load_data_in_place_ = load_data_in_place;
+  }
+  // @}
+
   // Loads a block-graph from the provided input archive. The data-mode and
   // attributes used in the serialization will also be updated. If an external
   // data source is required SetBlockDataCallback must be called prior to Load.
@@ -261,6 +276,8 @@ class BlockGraphSerializer {
   DataMode data_mode_;
   // Controls the specifics of how the serialization is performed.
   Attributes attributes_;
+  // Indicates whether block data is referenced in place when loading.
+  bool load_data_in_place_;
 
   // Optional callbacks.
   std::unique_ptr<SaveBlockDataCallback> save_block_data_callback_;
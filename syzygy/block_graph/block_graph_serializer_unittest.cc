@@ -543,6 +543,40 @@ TEST_F(BlockGraphSerializerTest, RoundTripAllData) {
       eNoBlockDataCallbacks, 0));
 }
 
+TEST_F(BlockGraphSerializerTest, RoundTripAllDataInPlace) {
+  InitBlockGraph();
+  InitOutArchive();
+  s_.set_data_mode(BlockGraphSerializer::OUTPUT_ALL_DATA);
+  ASSERT_TRUE(s_.Save(bg_, oa_.get()));
+
+  // Load from a stream over the raw buffer, which supports reading in place.
+  const uint8_t* begin = v_.data();
+  const uint8_t* end = begin + v_.size();
+  is_.reset(core::CreateByteInStream(begin, end));
+  ia_.reset(new core::NativeBinaryInArchive(is_.get()));
+
+  EXPECT_FALSE(s_.load_data_in_place());
+  s_.set_load_data_in_place(true);
+  EXPECT_TRUE(s_.load_data_in_place());
+
+  BlockGraph bg;
+  ASSERT_TRUE(s_.Load(&bg, ia_.get()));
+  ASSERT_TRUE(testing::BlockGraphsEqual(bg_, bg, s_));
+
+  // The block data points into the buffer.
+  size_t blocks_with_data = 0;
+  for (const auto& entry : bg.blocks()) {
+    const BlockGraph::Block& block = entry.second;
+    if (block.data_size() == 0)
+      continue;
+    ++blocks_with_data;
+    EXPECT_FALSE(block.owns_data());
+    EXPECT_LE(begin, block.data());
+    EXPECT_GE(end, block.data() + block.data_size());
+  }
+  EXPECT_LT(0u, blocks_with_data);
+}
+
 // TODO(chrisha): Do a heck of a lot more testing of protected member functions.
 
 }  // namespace block_graph
@@ -1235,6 +1235,50 @@ TEST(BlockGraphTest, Labels) {
   EXPECT_THAT(block->labels(), testing::ContainerEq(expected));
 }
 
+TEST(BlockGraphTest, ArenaStorage) {
+  BlockGraph image;
+  EXPECT_TRUE(image.arena() == NULL);
+  image.EnableArenaStorage();
+  BlockGraphArena* arena = image.arena();
+  ASSERT_TRUE(arena != NULL);
+  EXPECT_EQ(arena, image.blocks().get_allocator().arena());
+
+  BlockGraph::Block* b1 = image.AddBlock(BlockGraph::CODE_BLOCK, 0x20, "b1");
+  BlockGraph::Block* b2 = image.AddBlock(BlockGraph::DATA_BLOCK, 0x20, "b2");
+  EXPECT_EQ(arena, b1->references().get_allocator().arena());
+  EXPECT_EQ(arena, b1->referrers().get_allocator().arena());
+  EXPECT_EQ(arena, b1->labels().get_allocator().arena());
+
+  BlockGraph::Reference ref(BlockGraph::ABSOLUTE_REF, 4, b2, 0, 0);
+  ASSERT_TRUE(b1->SetReference(0, ref));
+  ASSERT_TRUE(b1->SetLabel(0, "label", BlockGraph::CODE_LABEL));
+  EXPECT_LT(0u, arena->allocated_bytes());
+  EXPECT_THAT(b2->referrers(), testing::Contains(std::make_pair(b1, 0)));
+
+  // Copies of the containers don't draw from the arena.
+  BlockGraph::Block::ReferenceMap references(b1->references());
+  EXPECT_TRUE(references.get_allocator().arena() == NULL);
+  EXPECT_THAT(references, testing::ContainerEq(b1->references()));
+
+  // Nor do those of a block graph without arena storage.
+  BlockGraph heap_image;
+  BlockGraph::Block* b3 =
+      heap_image.AddBlock(BlockGraph::CODE_BLOCK, 0x20, "b3");
+  EXPECT_TRUE(b3->references().get_allocator().arena() == NULL);
+
+  // Copied blocks draw from the arena.
+  BlockGraph::Block* b4 = image.CopyBlock(b1, "b4");
+  ASSERT_TRUE(b4 != NULL);
+  EXPECT_EQ(arena, b4->references().get_allocator().arena());
+  EXPECT_THAT(b4->references(), testing::ContainerEq(b1->references()));
+
+  ASSERT_TRUE(b1->RemoveReference(0));
+  ASSERT_TRUE(b4->RemoveReference(0));
+  EXPECT_TRUE(b2->referrers().empty());
+  EXPECT_TRUE(image.RemoveBlock(b1));
+  EXPECT_TRUE(image.RemoveBlock(b4));
+}
+
 TEST(BlockGraphTest, StringTable) {
   std::string str1 = "Dummy";
   std::string str2 = "Foo";
@@ -0,0 +1,281 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_hash_index.h"
+
+#include <algorithm>
+
+#include "base/atomicops.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/threading/simple_thread.h"
+#include "syzygy/core/serialization.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef BlockHashIndex::BlockHashVector BlockHashVector;
+typedef BlockHashIndex::ConstBlockVector ConstBlockVector;
+typedef BlockHashIndex::Entry Entry;
+typedef BlockHashIndex::EntryVector EntryVector;
+
+// The version of the index file format. Bump this whenever the format or the
+// computation of BlockHash change.
+const uint32_t kIndexVersion = 1;
+
+// The number of blocks a worker thread hashes at a time. Most blocks are
+// small, so handing them out one by one would have the threads spend their
+// time contending for the next one.
+const size_t kBlocksPerWorkItem = 256;
+
+// The work shared by the worker threads. Each run hashes the next slice of
+// blocks that no thread has claimed yet.
+class HashWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  HashWork(const ConstBlockVector& blocks, BlockHashVector* hashes)
+      : blocks_(blocks), hashes_(hashes), next_index_(0) {
+    DCHECK(hashes != NULL);
+    DCHECK_EQ(blocks.size(), hashes->size());
+  }
+
+  // @returns the number of work items needed to hash all of the blocks.
+  size_t work_items() const {
+    return (blocks_.size() + kBlocksPerWorkItem - 1) / kBlocksPerWorkItem;
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, work_items());
+    size_t begin = index * kBlocksPerWorkItem;
+    size_t end = std::min(begin + kBlocksPerWorkItem, blocks_.size());
+    for (size_t i = begin; i < end; ++i)
+      (*hashes_)[i].Hash(blocks_[i]);
+  }
+  // @}
+
+ private:
+  const ConstBlockVector& blocks_;
+  BlockHashVector* hashes_;
+  base::subtle::Atomic32 next_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(HashWork);
+};
+
+bool EntryLess(const Entry& entry0, const Entry& entry1) {
+  int c = entry0.hash.Compare(entry1.hash);
+  if (c != 0)
+    return c < 0;
+  return entry0.block_id < entry1.block_id;
+}
+
+bool EntryHashLess(const Entry& entry0, const Entry& entry1) {
+  return entry0.hash < entry1.hash;
+}
+
+// @returns the end of the run of entries starting at @p it that share its
+//     hash.
+EntryVector::const_iterator GetHashRunEnd(EntryVector::const_iterator it,
+                                          EntryVector::const_iterator end) {
+  DCHECK(it != end);
+  EntryVector::const_iterator run_end = it;
+  while (run_end != end && run_end->hash == it->hash)
+    ++run_end;
+  return run_end;
+}
+
+}  // namespace
+
+template<class OutArchive>
+bool BlockHashIndex::Entry::Save(OutArchive* out_archive) const {
+  for (size_t i = 0; i < sizeof(hash.md5_digest.a); ++i) {
+    if (!out_archive->Save(hash.md5_digest.a[i]))
+      return false;
+  }
+  return out_archive->Save(block_id);
+}
+
+template<class InArchive>
+bool BlockHashIndex::Entry::Load(InArchive* in_archive) {
+  for (size_t i = 0; i < sizeof(hash.md5_digest.a); ++i) {
+    if (!in_archive->Load(&hash.md5_digest.a[i]))
+      return false;
+  }
+  return in_archive->Load(&block_id);
+}
+
+BlockHashIndex::BlockHashIndex() {
+}
+
+BlockHashIndex::~BlockHashIndex() {
+}
+
+void BlockHashIndex::HashBlocks(const ConstBlockVector& blocks,
+                                size_t num_threads,
+                                BlockHashVector* hashes) {
+  DCHECK_LT(0U, num_threads);
+  DCHECK(hashes != NULL);
+
+  hashes->clear();
+  hashes->resize(blocks.size());
+
+  HashWork work(blocks, hashes);
+  size_t work_items = work.work_items();
+  if (num_threads == 1 || work_items <= 1) {
+    for (size_t i = 0; i < work_items; ++i)
+      work.Run();
+    return;
+  }
+
+  base::DelegateSimpleThreadPool pool(
+      "BlockHashIndex",
+      static_cast<int>(std::min(num_threads, work_items)));
+  pool.Start();
+  pool.AddWork(&work, static_cast<int>(work_items));
+  pool.JoinAll();
+}
+
+void BlockHashIndex::Build(const BlockGraph& block_graph, size_t num_threads) {
+  DCHECK_LT(0U, num_threads);
+
+  ConstBlockVector blocks;
+  blocks.reserve(block_graph.blocks().size());
+  for (const auto& entry : block_graph.blocks())
+    blocks.push_back(&entry.second);
+
+  Build(blocks, num_threads);
+}
+
+void BlockHashIndex::Build(const ConstBlockVector& blocks,
+                           size_t num_threads) {
+  DCHECK_LT(0U, num_threads);
+
+  BlockHashVector hashes;
+  HashBlocks(blocks, num_threads, &hashes);
+
+  entries_.clear();
+  entries_.resize(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    entries_[i].hash = hashes[i];
+    entries_[i].block_id = blocks[i]->id();
+  }
+  std::sort(entries_.begin(), entries_.end(), &EntryLess);
+}
+
+size_t BlockHashIndex::Find(const BlockHash& hash,
+                            BlockIdVector* block_ids) const {
+  DCHECK(block_ids != NULL);
+
+  Entry key = {};
+  key.hash = hash;
+  std::pair<EntryVector::const_iterator, EntryVector::const_iterator> range =
+      std::equal_range(entries_.begin(), entries_.end(), key, &EntryHashLess);
+
+  block_ids->clear();
+  for (EntryVector::const_iterator it = range.first; it != range.second; ++it)
+    block_ids->push_back(it->block_id);
+  return block_ids->size();
+}
+
+void BlockHashIndex::MatchUnique(const BlockHashIndex& other,
+                                 BlockIdPairVector* matches) const {
+  DCHECK(matches != NULL);
+
+  matches->clear();
+
+  // Walk both sorted indices in lockstep, one run of equal hashes at a time.
+  EntryVector::const_iterator it0 = entries_.begin();
+  EntryVector::const_iterator it1 = other.entries_.begin();
+  while (it0 != entries_.end() && it1 != other.entries_.end()) {
+    int c = it0->hash.Compare(it1->hash);
+    if (c < 0) {
+      it0 = GetHashRunEnd(it0, entries_.end());
+      continue;
+    }
+    if (c > 0) {
+      it1 = GetHashRunEnd(it1, other.entries_.end());
+      continue;
+    }
+
+    EntryVector::const_iterator end0 = GetHashRunEnd(it0, entries_.end());
+    EntryVector::const_iterator end1 =
+        GetHashRunEnd(it1, other.entries_.end());
+    if (end0 - it0 == 1 && end1 - it1 == 1)
+      matches->push_back(std::make_pair(it0->block_id, it1->block_id));
+    it0 = end0;
+    it1 = end1;
+  }
+}
+
+bool BlockHashIndex::Load(const base::FilePath& path) {
+  entries_.clear();
+
+  base::ScopedFILE file(base::OpenFile(path, "rb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to open block hash index: " << path.value();
+    return false;
+  }
+
+  core::FileInStream file_stream(file.get());
+  core::BufferedInStream in_stream(&file_stream);
+  core::NativeBinaryInArchive in_archive(&in_stream);
+  uint32_t version = 0;
+  if (!in_archive.Load(&version)) {
+    LOG(ERROR) << "Unable to read block hash index: " << path.value();
+    return false;
+  }
+  if (version != kIndexVersion) {
+    LOG(ERROR) << "Unsupported version " << version << " of block hash "
+               << "index: " << path.value();
+    return false;
+  }
+  if (!in_archive.Load(&entries_)) {
+    LOG(ERROR) << "Unable to read block hash index: " << path.value();
+    entries_.clear();
+    return false;
+  }
+
+  if (!std::is_sorted(entries_.begin(), entries_.end(), &EntryLess)) {
+    LOG(ERROR) << "Corrupt block hash index: " << path.value();
+    entries_.clear();
+    return false;
+  }
+
+  return true;
+}
+
+bool BlockHashIndex::Save(const base::FilePath& path) const {
+  base::ScopedFILE file(base::OpenFile(path, "wb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to create block hash index: " << path.value();
+    return false;
+  }
+
+  core::FileOutStream file_stream(file.get());
+  core::BufferedOutStream out_stream(&file_stream);
+  core::NativeBinaryOutArchive out_archive(&out_stream);
+  if (!out_archive.Save(kIndexVersion) ||
+      !out_archive.Save(entries_) ||
+      !out_archive.Flush()) {
+    LOG(ERROR) << "Unable to write block hash index: " << path.value();
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace block_graph
@@ -0,0 +1,118 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the bulk computation of the BlockHash of the blocks of a block
+// graph, and an index from these hashes to the blocks. Hashing only reads the
+// blocks, so it's spread over a pool of worker threads. The index is a sorted
+// vector, so that the blocks of two images can be matched by hash in a single
+// pass over both indices, and it can be saved alongside a serialized block
+// graph so that later runs needn't hash the blocks again.
+
+#ifndef SYZYGY_BLOCK_GRAPH_BLOCK_HASH_INDEX_H_
+#define SYZYGY_BLOCK_GRAPH_BLOCK_HASH_INDEX_H_
+
+#include <utility>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "syzygy/block_graph/block_graph.h"
+#include "syzygy/block_graph/block_hash.h"
+
+namespace block_graph {
+
+class BlockHashIndex {
+ public:
+  typedef std::vector<const BlockGraph::Block*> ConstBlockVector;
+  typedef std::vector<BlockHash> BlockHashVector;
+  typedef std::vector<BlockGraph::BlockId> BlockIdVector;
+
+  // An entry of the index.
+  struct Entry {
+    template<class OutArchive> bool Save(OutArchive* out_archive) const;
+    template<class InArchive> bool Load(InArchive* in_archive);
+
+    BlockHash hash;
+    BlockGraph::BlockId block_id;
+  };
+  typedef std::vector<Entry> EntryVector;
+
+  // A pair of blocks with the same hash, one from each of two indices.
+  typedef std::pair<BlockGraph::BlockId, BlockGraph::BlockId> BlockIdPair;
+  typedef std::vector<BlockIdPair> BlockIdPairVector;
+
+  BlockHashIndex();
+  ~BlockHashIndex();
+
+  // Hashes a set of blocks.
+  // @param blocks The blocks to hash.
+  // @param num_threads The number of worker threads to hash with.
+  // @param hashes Receives the hashes of @p blocks, in the same order.
+  static void HashBlocks(const ConstBlockVector& blocks,
+                         size_t num_threads,
+                         BlockHashVector* hashes);
+
+  // Builds the index of the blocks of a block graph, discarding the current
+  // content of the index.
+  // @param block_graph The block graph to index.
+  // @param num_threads The number of worker threads to hash with.
+  void Build(const BlockGraph& block_graph, size_t num_threads);
+
+  // Builds the index of a subset of the blocks of a block graph, discarding
+  // the current content of the index.
+  // @param blocks The blocks to index.
+  // @param num_threads The number of worker threads to hash with.
+  void Build(const ConstBlockVector& blocks, size_t num_threads);
+
+  // Finds the blocks with a given hash.
+  // @param hash The hash to look up.
+  // @param block_ids Receives the IDs of the blocks with @p hash, in
+  //     increasing order.
+  // @returns the number of blocks found.
+  size_t Find(const BlockHash& hash, BlockIdVector* block_ids) const;
+
+  // Finds the blocks that are unique to their hash in both this index and
+  // another one.
+  // @param other The other index.
+  // @param matches Receives the pairs of matching blocks, the first member
+  //     of each belonging to this index. These are ordered by hash.
+  void MatchUnique(const BlockHashIndex& other,
+                   BlockIdPairVector* matches) const;
+
+  // Loads the index from a file, discarding its current content.
+  // @param path The path of the index file.
+  // @returns true on success, false otherwise.
+  bool Load(const base::FilePath& path);
+
+  // Saves the index to a file.
+  // @param path The path of the index file.
+  // @returns true on success, false otherwise.
+  bool Save(const base::FilePath& path) const;
+
+  // @name Accessors.
+  // @{
+  const EntryVector& entries() const { return entries_; }
+  size_t size() const { return entries_.size(); }
+  // @}
+
+ protected:
+  // The entries, sorted by hash and then by block ID.
+  EntryVector entries_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BlockHashIndex);
+};
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_BLOCK_HASH_INDEX_H_
@@ -0,0 +1,162 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_hash_index.h"
+
+#include <algorithm>
+
+#include "base/files/scoped_temp_dir.h"
+#include "base/strings/stringprintf.h"
+#include "gtest/gtest.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef BlockHashIndex::BlockIdPair BlockIdPair;
+typedef BlockHashIndex::BlockIdPairVector BlockIdPairVector;
+typedef BlockHashIndex::BlockIdVector BlockIdVector;
+
+class BlockHashIndexTest : public testing::Test {
+ public:
+  // Adds a data block whose content is made of @p value.
+  static BlockGraph::Block* AddBlock(BlockGraph* block_graph, uint8_t value) {
+    const size_t kBlockSize = 16;
+    BlockGraph::Block* block = block_graph->AddBlock(
+        BlockGraph::DATA_BLOCK, kBlockSize,
+        base::StringPrintf("block %d", value));
+    ::memset(block->ResizeData(kBlockSize), value, kBlockSize);
+    return block;
+  }
+};
+
+}  // namespace
+
+TEST_F(BlockHashIndexTest, HashBlocksInParallel) {
+  // Enough blocks for several work items.
+  BlockGraph block_graph;
+  BlockHashIndex::ConstBlockVector blocks;
+  for (size_t i = 0; i < 1000; ++i)
+    blocks.push_back(AddBlock(&block_graph, static_cast<uint8_t>(i)));
+
+  BlockHashIndex::BlockHashVector serial_hashes;
+  BlockHashIndex::HashBlocks(blocks, 1, &serial_hashes);
+  BlockHashIndex::BlockHashVector parallel_hashes;
+  BlockHashIndex::HashBlocks(blocks, 4, &parallel_hashes);
+
+  ASSERT_EQ(blocks.size(), serial_hashes.size());
+  ASSERT_EQ(blocks.size(), parallel_hashes.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    EXPECT_EQ(BlockHash(blocks[i]), serial_hashes[i]);
+    EXPECT_EQ(BlockHash(blocks[i]), parallel_hashes[i]);
+  }
+}
+
+TEST_F(BlockHashIndexTest, BuildAndFind) {
+  BlockGraph block_graph;
+  BlockGraph::Block* block0 = AddBlock(&block_graph, 0);
+  BlockGraph::Block* block1 = AddBlock(&block_graph, 1);
+  BlockGraph::Block* block2 = AddBlock(&block_graph, 1);
+
+  BlockHashIndex index;
+  index.Build(block_graph, 2);
+  EXPECT_EQ(3u, index.size());
+
+  BlockIdVector block_ids;
+  EXPECT_EQ(1u, index.Find(BlockHash(block0), &block_ids));
+  EXPECT_EQ(block0->id(), block_ids[0]);
+
+  EXPECT_EQ(2u, index.Find(BlockHash(block1), &block_ids));
+  EXPECT_EQ(block1->id(), block_ids[0]);
+  EXPECT_EQ(block2->id(), block_ids[1]);
+
+  BlockGraph other_block_graph;
+  BlockGraph::Block* other_block = AddBlock(&other_block_graph, 2);
+  EXPECT_EQ(0u, index.Find(BlockHash(other_block), &block_ids));
+  EXPECT_TRUE(block_ids.empty());
+}
+
+TEST_F(BlockHashIndexTest, BuildSubset) {
+  BlockGraph block_graph;
+  BlockGraph::Block* block0 = AddBlock(&block_graph, 0);
+  BlockGraph::Block* block1 = AddBlock(&block_graph, 1);
+  AddBlock(&block_graph, 1);
+
+  BlockHashIndex::ConstBlockVector blocks;
+  blocks.push_back(block0);
+  blocks.push_back(block1);
+  BlockHashIndex index;
+  index.Build(blocks, 2);
+  EXPECT_EQ(2u, index.size());
+
+  // The block left out of the index isn't found.
+  BlockIdVector block_ids;
+  EXPECT_EQ(1u, index.Find(BlockHash(block1), &block_ids));
+  EXPECT_EQ(block1->id(), block_ids[0]);
+}
+
+TEST_F(BlockHashIndexTest, MatchUnique) {
+  BlockGraph block_graph0;
+  BlockGraph::Block* block00 = AddBlock(&block_graph0, 0);
+  AddBlock(&block_graph0, 1);
+  AddBlock(&block_graph0, 1);
+  AddBlock(&block_graph0, 2);
+  BlockGraph::Block* block04 = AddBlock(&block_graph0, 4);
+
+  BlockGraph block_graph1;
+  BlockGraph::Block* block14 = AddBlock(&block_graph1, 4);
+  AddBlock(&block_graph1, 1);
+  AddBlock(&block_graph1, 3);
+  BlockGraph::Block* block10 = AddBlock(&block_graph1, 0);
+
+  BlockHashIndex index0;
+  index0.Build(block_graph0, 1);
+  BlockHashIndex index1;
+  index1.Build(block_graph1, 1);
+
+  // Only the blocks made of 0 and 4 are unique to their hash in both images.
+  BlockIdPairVector matches;
+  index0.MatchUnique(index1, &matches);
+  ASSERT_EQ(2u, matches.size());
+  std::sort(matches.begin(), matches.end());
+  EXPECT_EQ(BlockIdPair(block00->id(), block10->id()), matches[0]);
+  EXPECT_EQ(BlockIdPair(block04->id(), block14->id()), matches[1]);
+}
+
+TEST_F(BlockHashIndexTest, SaveAndLoad) {
+  BlockGraph block_graph;
+  for (size_t i = 0; i < 10; ++i)
+    AddBlock(&block_graph, static_cast<uint8_t>(i % 3));
+  BlockHashIndex index;
+  index.Build(block_graph, 1);
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath path = temp_dir.path().AppendASCII("index.bin");
+  ASSERT_TRUE(index.Save(path));
+
+  BlockHashIndex loaded_index;
+  ASSERT_TRUE(loaded_index.Load(path));
+  ASSERT_EQ(index.size(), loaded_index.size());
+  for (size_t i = 0; i < index.size(); ++i) {
+    EXPECT_EQ(index.entries()[i].hash, loaded_index.entries()[i].hash);
+    EXPECT_EQ(index.entries()[i].block_id, loaded_index.entries()[i].block_id);
+  }
+
+  // A missing file can't be loaded.
+  EXPECT_FALSE(loaded_index.Load(temp_dir.path().AppendASCII("missing.bin")));
+  EXPECT_EQ(0u, loaded_index.size());
+}
+
+}  // namespace block_graph
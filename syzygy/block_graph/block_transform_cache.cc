@@ -0,0 +1,599 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_transform_cache.h"
+
+#include <algorithm>
+#include <map>
+
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/md5.h"
+#include "syzygy/block_graph/block_hash.h"
+#include "syzygy/core/serialization.h"
+
+namespace block_graph {
+
+namespace {
+
+using base::MD5Context;
+using base::MD5Digest;
+using base::MD5Final;
+using base::MD5Init;
+using base::MD5Update;
+using base::StringPiece;
+
+// The version of the cache file format. Bump this whenever the format or the
+// computation of the keys change.
+const uint32_t kCacheVersion = 1;
+
+// Hashes a plain value.
+template<typename T>
+void UpdateDigest(const T& value, MD5Context* context) {
+  MD5Update(context,
+            StringPiece(reinterpret_cast<const char*>(&value), sizeof(value)));
+}
+
+core::RelativeAddress kInvalidAddress(core::RelativeAddress::kInvalidAddress);
+
+// @returns the lowest source address of @p block, or kInvalidAddress if it has
+//     no source ranges.
+core::RelativeAddress GetSourceBase(const BlockGraph::Block* block) {
+  DCHECK(block != NULL);
+  core::RelativeAddress source_base = kInvalidAddress;
+  for (const auto& range_pair : block->source_ranges().range_pairs()) {
+    if (source_base == kInvalidAddress ||
+        range_pair.second.start() < source_base) {
+      source_base = range_pair.second.start();
+    }
+  }
+  return source_base;
+}
+
+}  // namespace
+
+template<class OutArchive>
+bool BlockTransformCache::Entry::Label::Save(OutArchive* out_archive) const {
+  return out_archive->Save(offset) && out_archive->Save(name) &&
+         out_archive->Save(attributes);
+}
+
+template<class InArchive>
+bool BlockTransformCache::Entry::Label::Load(InArchive* in_archive) {
+  return in_archive->Load(&offset) && in_archive->Load(&name) &&
+         in_archive->Load(&attributes);
+}
+
+template<class OutArchive>
+bool BlockTransformCache::Entry::Reference::Save(
+    OutArchive* out_archive) const {
+  return out_archive->Save(source_offset) && out_archive->Save(type) &&
+         out_archive->Save(size) && out_archive->Save(kind) &&
+         out_archive->Save(index) && out_archive->Save(offset) &&
+         out_archive->Save(base);
+}
+
+template<class InArchive>
+bool BlockTransformCache::Entry::Reference::Load(InArchive* in_archive) {
+  return in_archive->Load(&source_offset) && in_archive->Load(&type) &&
+         in_archive->Load(&size) && in_archive->Load(&kind) &&
+         in_archive->Load(&index) && in_archive->Load(&offset) &&
+         in_archive->Load(&base);
+}
+
+template<class OutArchive>
+bool BlockTransformCache::Entry::SourceRange::Save(
+    OutArchive* out_archive) const {
+  return out_archive->Save(data_offset) && out_archive->Save(data_size) &&
+         out_archive->Save(source_offset) && out_archive->Save(source_size);
+}
+
+template<class InArchive>
+bool BlockTransformCache::Entry::SourceRange::Load(InArchive* in_archive) {
+  return in_archive->Load(&data_offset) && in_archive->Load(&data_size) &&
+         in_archive->Load(&source_offset) && in_archive->Load(&source_size);
+}
+
+BlockTransformCache::Entry::Entry()
+    : size(0),
+      attributes(0),
+      alignment(1),
+      alignment_offset(0),
+      padding_before(0) {
+}
+
+template<class OutArchive>
+bool BlockTransformCache::Entry::Save(OutArchive* out_archive) const {
+  return out_archive->Save(size) && out_archive->Save(data) &&
+         out_archive->Save(attributes) && out_archive->Save(alignment) &&
+         out_archive->Save(alignment_offset) &&
+         out_archive->Save(padding_before) && out_archive->Save(labels) &&
+         out_archive->Save(references) && out_archive->Save(referrers) &&
+         out_archive->Save(source_ranges);
+}
+
+template<class InArchive>
+bool BlockTransformCache::Entry::Load(InArchive* in_archive) {
+  return in_archive->Load(&size) && in_archive->Load(&data) &&
+         in_archive->Load(&attributes) && in_archive->Load(&alignment) &&
+         in_archive->Load(&alignment_offset) &&
+         in_archive->Load(&padding_before) && in_archive->Load(&labels) &&
+         in_archive->Load(&references) && in_archive->Load(&referrers) &&
+         in_archive->Load(&source_ranges);
+}
+
+BlockTransformCache::BlockTransformCache()
+    : configured_(false), hits_(0), misses_(0) {
+}
+
+BlockTransformCache::~BlockTransformCache() {
+}
+
+bool BlockTransformCache::Load(const base::FilePath& path) {
+  configuration_.clear();
+  entries_.clear();
+  used_entries_.clear();
+
+  if (!base::PathExists(path))
+    return true;
+
+  base::ScopedFILE file(base::OpenFile(path, "rb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to open transform cache: " << path.value();
+    return false;
+  }
+
+  core::FileInStream file_stream(file.get());
+  core::BufferedInStream in_stream(&file_stream);
+  core::NativeBinaryInArchive in_archive(&in_stream);
+  uint32_t version = 0;
+  if (!in_archive.Load(&version) || version != kCacheVersion ||
+      !in_archive.Load(&configuration_) || !in_archive.Load(&entries_)) {
+    LOG(WARNING) << "Ignoring invalid or outdated transform cache: "
+                 << path.value();
+    configuration_.clear();
+    entries_.clear();
+  }
+
+  return true;
+}
+
+bool BlockTransformCache::Save(const base::FilePath& path) const {
+  base::ScopedFILE file(base::OpenFile(path, "wb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to create transform cache: " << path.value();
+    return false;
+  }
+
+  core::FileOutStream file_stream(file.get());
+  core::BufferedOutStream out_stream(&file_stream);
+  core::NativeBinaryOutArchive out_archive(&out_stream);
+  if (!out_archive.Save(kCacheVersion) ||
+      !out_archive.Save(configuration_) ||
+      !out_archive.Save(used_entries_) ||
+      !out_archive.Flush()) {
+    LOG(ERROR) << "Unable to write transform cache: " << path.value();
+    return false;
+  }
+
+  return true;
+}
+
+void BlockTransformCache::SetConfiguration(
+    const base::StringPiece& configuration,
+    const BlockVector& external_blocks) {
+  if (configuration != configuration_) {
+    if (!entries_.empty() || !used_entries_.empty())
+      LOG(INFO) << "Transform configuration changed, emptying the cache.";
+    configuration.CopyToString(&configuration_);
+    entries_.clear();
+    used_entries_.clear();
+  }
+  external_blocks_ = external_blocks;
+  configured_ = true;
+}
+
+bool BlockTransformCache::ApplyTransform(
+    BasicBlockSubGraphTransformInterface* transform,
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    BlockGraph::Block* block) {
+  DCHECK(transform != NULL);
+  DCHECK(policy != NULL);
+  DCHECK(block_graph != NULL);
+  DCHECK(block != NULL);
+  DCHECK_EQ(BlockGraph::CODE_BLOCK, block->type());
+  DCHECK(configured_);
+
+  std::string key = ComputeKey(block);
+
+  // Replay a previous outcome if there is one. The same block may appear more
+  // than once in an image, so the entries used during this run are looked up
+  // as well.
+  EntryMap::iterator it = used_entries_.find(key);
+  if (it == used_entries_.end()) {
+    it = entries_.find(key);
+    if (it != entries_.end()) {
+      Entry& used_entry = used_entries_[key];
+      std::swap(used_entry, it->second);
+      entries_.erase(it);
+      it = used_entries_.find(key);
+    }
+  }
+  if (it != used_entries_.end()) {
+    if (Replay(it->second, block_graph, block)) {
+      ++hits_;
+      return true;
+    }
+    // This can only happen if the key misses something that matters, drop the
+    // entry rather than trying it again.
+    LOG(WARNING) << "Unable to replay the cached transform of block \""
+                 << block->name() << "\".";
+    used_entries_.erase(it);
+  }
+
+  ++misses_;
+  Snapshot snapshot;
+  TakeSnapshot(block, &snapshot);
+
+  BlockVector new_blocks;
+  if (!ApplyBasicBlockSubGraphTransform(transform, policy, block_graph, block,
+                                        &new_blocks)) {
+    return false;
+  }
+
+  Entry entry;
+  if (new_blocks.size() == 1 && Record(snapshot, new_blocks.front(), &entry))
+    std::swap(used_entries_[key], entry);
+
+  return true;
+}
+
+std::string BlockTransformCache::ComputeKey(const BlockGraph::Block* block) {
+  DCHECK(block != NULL);
+
+  MD5Context context;
+  MD5Init(&context);
+
+  // The content of the block.
+  BlockHash hash(block);
+  UpdateDigest(hash.md5_digest, &context);
+  UpdateDigest(block->attributes(), &context);
+  UpdateDigest(block->alignment(), &context);
+  UpdateDigest(block->alignment_offset(), &context);
+  UpdateDigest(block->padding_before(), &context);
+
+  // The decomposer relies on the type of the references' targets, and on the
+  // exact destination of the references the block makes to itself. Other
+  // references are carried over as is.
+  //
+  // Which references share a target, and a destination, matters as well, as
+  // these are what the transformed references are mapped back to.
+  typedef std::pair<BlockGraph::Offset, BlockGraph::Offset> Destination;
+  std::map<const BlockGraph::Block*, size_t> first_by_target;
+  std::map<std::pair<const BlockGraph::Block*, Destination>, size_t>
+      first_by_destination;
+  size_t index = 0;
+  for (const auto& ref : block->references()) {
+    const BlockGraph::Block* target = ref.second.referenced();
+    Destination destination(ref.second.offset(), ref.second.base());
+    bool is_self = target == block;
+    UpdateDigest(is_self, &context);
+    UpdateDigest(target->type(), &context);
+    UpdateDigest(target->attributes(), &context);
+    if (is_self) {
+      UpdateDigest(destination, &context);
+    } else {
+      UpdateDigest(first_by_target.insert(
+          std::make_pair(target, index)).first->second, &context);
+      UpdateDigest(first_by_destination.insert(std::make_pair(
+          std::make_pair(target, destination), index)).first->second,
+          &context);
+    }
+    ++index;
+  }
+
+  // The source ranges are made relative to their lowest address, as the blocks
+  // move from one build to the next.
+  core::RelativeAddress source_base = GetSourceBase(block);
+  UpdateDigest(block->source_ranges().size(), &context);
+  for (const auto& range_pair : block->source_ranges().range_pairs()) {
+    UpdateDigest(range_pair.first.start(), &context);
+    UpdateDigest(range_pair.first.size(), &context);
+    UpdateDigest(range_pair.second.start() - source_base, &context);
+    UpdateDigest(range_pair.second.size(), &context);
+  }
+
+  for (const auto& label : block->labels()) {
+    UpdateDigest(label.first, &context);
+    UpdateDigest(label.second.attributes(), &context);
+    UpdateDigest(label.second.name().size(), &context);
+    MD5Update(&context, label.second.name());
+  }
+
+  // The references made to the block by other blocks. These are sorted, as the
+  // referrers are keyed by pointer.
+  std::vector<std::pair<BlockGraph::Offset, BlockGraph::Offset>> referrers;
+  for (const auto& referrer : block->referrers()) {
+    if (referrer.first == block)
+      continue;
+    BlockGraph::Reference ref;
+    bool found = referrer.first->GetReference(referrer.second, &ref);
+    DCHECK(found);
+    referrers.push_back(std::make_pair(ref.offset(), ref.base()));
+  }
+  std::sort(referrers.begin(), referrers.end());
+  UpdateDigest(referrers.size(), &context);
+  for (const auto& referrer : referrers)
+    UpdateDigest(referrer, &context);
+
+  MD5Digest digest;
+  MD5Final(&digest, &context);
+  return std::string(reinterpret_cast<const char*>(digest.a),
+                     sizeof(digest.a));
+}
+
+void BlockTransformCache::TakeSnapshot(const BlockGraph::Block* block,
+                                       Snapshot* snapshot) {
+  DCHECK(block != NULL);
+  DCHECK(snapshot != NULL);
+
+  snapshot->source_base = GetSourceBase(block);
+  snapshot->references.assign(block->references().begin(),
+                              block->references().end());
+  snapshot->referrers.clear();
+  for (const auto& referrer : block->referrers()) {
+    if (referrer.first == block)
+      continue;
+    BlockGraph::Reference ref;
+    bool found = referrer.first->GetReference(referrer.second, &ref);
+    DCHECK(found);
+    Snapshot::Referrer snapshot_referrer = {
+        referrer.first, referrer.second,
+        OffsetAndBase(static_cast<int32_t>(ref.offset()),
+                      static_cast<int32_t>(ref.base())) };
+    snapshot->referrers.push_back(snapshot_referrer);
+  }
+}
+
+bool BlockTransformCache::Record(const Snapshot& snapshot,
+                                 const BlockGraph::Block* new_block,
+                                 Entry* entry) const {
+  DCHECK(new_block != NULL);
+  DCHECK(entry != NULL);
+
+  entry->size = static_cast<uint32_t>(new_block->size());
+  if (new_block->data_size() != 0) {
+    entry->data.assign(new_block->data(),
+                       new_block->data() + new_block->data_size());
+  }
+  entry->attributes = new_block->attributes();
+  entry->alignment = static_cast<uint32_t>(new_block->alignment());
+  entry->alignment_offset =
+      static_cast<int32_t>(new_block->alignment_offset());
+  entry->padding_before = static_cast<uint32_t>(new_block->padding_before());
+
+  for (const auto& label : new_block->labels()) {
+    Entry::Label entry_label = { static_cast<int32_t>(label.first),
+                                 label.second.name(),
+                                 label.second.attributes() };
+    entry->labels.push_back(entry_label);
+  }
+
+  for (const auto& ref : new_block->references()) {
+    Entry::Reference entry_ref = {};
+    entry_ref.source_offset = static_cast<int32_t>(ref.first);
+    entry_ref.type = ref.second.type();
+    entry_ref.size = static_cast<uint32_t>(ref.second.size());
+    entry_ref.offset = static_cast<int32_t>(ref.second.offset());
+    entry_ref.base = static_cast<int32_t>(ref.second.base());
+
+    const BlockGraph::Block* target = ref.second.referenced();
+    if (target == new_block) {
+      entry_ref.kind = kSelfReference;
+      entry->references.push_back(entry_ref);
+      continue;
+    }
+
+    // Prefer an original reference with the same destination, and otherwise
+    // fall back to the first one with the same target.
+    size_t i = snapshot.references.size();
+    for (size_t j = 0; j < snapshot.references.size(); ++j) {
+      const BlockGraph::Reference& original = snapshot.references[j].second;
+      if (original.referenced() != target)
+        continue;
+      if (original.offset() == ref.second.offset() &&
+          original.base() == ref.second.base()) {
+        i = j;
+        break;
+      }
+      if (i == snapshot.references.size())
+        i = j;
+    }
+    if (i < snapshot.references.size()) {
+      const BlockGraph::Reference& original = snapshot.references[i].second;
+      entry_ref.kind = kOriginalReference;
+      entry_ref.index = static_cast<uint32_t>(i);
+      entry_ref.offset -= static_cast<int32_t>(original.offset());
+      entry_ref.base -= static_cast<int32_t>(original.base());
+      entry->references.push_back(entry_ref);
+      continue;
+    }
+
+    BlockVector::const_iterator external_it =
+        std::find(external_blocks_.begin(), external_blocks_.end(), target);
+    if (external_it == external_blocks_.end())
+      return false;
+    entry_ref.kind = kExternalReference;
+    entry_ref.index =
+        static_cast<uint32_t>(external_it - external_blocks_.begin());
+    entry->references.push_back(entry_ref);
+  }
+
+  for (const auto& referrer : snapshot.referrers) {
+    // The referrers are left in place, and now refer to the new block.
+    BlockGraph::Reference ref;
+    if (!referrer.block->GetReference(referrer.source_offset, &ref) ||
+        ref.referenced() != new_block) {
+      return false;
+    }
+    OffsetAndBase destination(static_cast<int32_t>(ref.offset()),
+                              static_cast<int32_t>(ref.base()));
+    auto result = entry->referrers.insert(
+        std::make_pair(referrer.destination, destination));
+    if (!result.second && result.first->second != destination)
+      return false;
+  }
+
+  // The source ranges are made relative to those of the original block.
+  if (snapshot.source_base != kInvalidAddress) {
+    for (const auto& range_pair : new_block->source_ranges().range_pairs()) {
+      const BlockGraph::Block::DataRange& data_range = range_pair.first;
+      const BlockGraph::Block::SourceRange& source_range = range_pair.second;
+      if (source_range.start() < snapshot.source_base)
+        continue;
+      Entry::SourceRange entry_range = {
+          static_cast<int32_t>(data_range.start()),
+          static_cast<uint32_t>(data_range.size()),
+          static_cast<uint32_t>(source_range.start() - snapshot.source_base),
+          static_cast<uint32_t>(source_range.size()) };
+      entry->source_ranges.push_back(entry_range);
+    }
+  }
+
+  return true;
+}
+
+bool BlockTransformCache::Replay(const Entry& entry,
+                                 BlockGraph* block_graph,
+                                 BlockGraph::Block* block) const {
+  DCHECK(block_graph != NULL);
+  DCHECK(block != NULL);
+
+  // Check that the entry applies before touching the block graph.
+  std::vector<BlockGraph::Reference> original_references;
+  for (const auto& ref : block->references())
+    original_references.push_back(ref.second);
+  for (const auto& entry_ref : entry.references) {
+    switch (entry_ref.kind) {
+      case kSelfReference:
+        break;
+      case kOriginalReference:
+        if (entry_ref.index >= original_references.size() ||
+            original_references[entry_ref.index].referenced() == block) {
+          return false;
+        }
+        break;
+      case kExternalReference:
+        if (entry_ref.index >= external_blocks_.size())
+          return false;
+        break;
+      default:
+        return false;
+    }
+  }
+
+  std::vector<std::pair<BlockGraph::Block*, BlockGraph::Offset>> referrers;
+  for (const auto& referrer : block->referrers()) {
+    if (referrer.first == block)
+      continue;
+    BlockGraph::Reference ref;
+    bool found = referrer.first->GetReference(referrer.second, &ref);
+    DCHECK(found);
+    OffsetAndBase destination(static_cast<int32_t>(ref.offset()),
+                              static_cast<int32_t>(ref.base()));
+    if (entry.referrers.find(destination) == entry.referrers.end())
+      return false;
+    referrers.push_back(referrer);
+  }
+
+  // Build the new block.
+  BlockGraph::Block* new_block =
+      block_graph->AddBlock(block->type(), entry.size, block->name());
+  DCHECK(new_block != NULL);
+  new_block->set_section(block->section());
+  new_block->set_attributes(entry.attributes);
+  new_block->set_alignment(entry.alignment);
+  new_block->set_alignment_offset(entry.alignment_offset);
+  new_block->set_padding_before(entry.padding_before);
+  if (!entry.data.empty())
+    new_block->CopyData(entry.data.size(), &entry.data[0]);
+
+  for (const auto& label : entry.labels) {
+    bool inserted = new_block->SetLabel(label.offset, label.name,
+                                        label.attributes);
+    DCHECK(inserted);
+  }
+
+  core::RelativeAddress source_base = GetSourceBase(block);
+  if (source_base != kInvalidAddress) {
+    for (const auto& range : entry.source_ranges) {
+      new_block->source_ranges().Push(
+          BlockGraph::Block::DataRange(range.data_offset, range.data_size),
+          BlockGraph::Block::SourceRange(source_base + range.source_offset,
+                                         range.source_size));
+    }
+  }
+
+  for (const auto& entry_ref : entry.references) {
+    BlockGraph::ReferenceType type =
+        static_cast<BlockGraph::ReferenceType>(entry_ref.type);
+    BlockGraph::Block* target = NULL;
+    BlockGraph::Offset offset = entry_ref.offset;
+    BlockGraph::Offset base = entry_ref.base;
+    switch (entry_ref.kind) {
+      case kSelfReference:
+        target = new_block;
+        break;
+      case kOriginalReference: {
+        const BlockGraph::Reference& original =
+            original_references[entry_ref.index];
+        target = original.referenced();
+        offset += original.offset();
+        base += original.base();
+        break;
+      }
+      case kExternalReference:
+        target = external_blocks_[entry_ref.index];
+        break;
+    }
+    DCHECK(target != NULL);
+    new_block->SetReference(
+        entry_ref.source_offset,
+        BlockGraph::Reference(type, entry_ref.size, target, offset, base));
+  }
+
+  // Redirect the referrers to the new block.
+  for (const auto& referrer : referrers) {
+    BlockGraph::Reference ref;
+    bool found = referrer.first->GetReference(referrer.second, &ref);
+    DCHECK(found);
+    const OffsetAndBase& destination = entry.referrers.find(
+        OffsetAndBase(static_cast<int32_t>(ref.offset()),
+                      static_cast<int32_t>(ref.base())))->second;
+    referrer.first->SetReference(
+        referrer.second,
+        BlockGraph::Reference(ref.type(), ref.size(), new_block,
+                              destination.first, destination.second));
+  }
+
+  // Finally, get rid of the original block.
+  block->RemoveAllReferences();
+  bool removed = block_graph->RemoveBlock(block);
+  DCHECK(removed);
+
+  return true;
+}
+
+}  // namespace block_graph
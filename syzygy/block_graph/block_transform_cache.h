@@ -0,0 +1,244 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a cache of the outcome of basic-block transforms, persisted across
+// runs. Re-instrumenting an image after a small change mostly transforms
+// blocks that are identical to those of the previous run. The cache records
+// the block each transformed block was replaced with, keyed by a hash of
+// everything the transform depends on, and replays it on later runs instead
+// of decomposing, transforming and rebuilding the block again.
+//
+// Only transforms that replace a block with exactly one new block are cached.
+// The new block may refer to itself, to the blocks the original block refers
+// to, and to a set of external blocks that is provided by the client of the
+// cache (e.g., the import thunks of the instrumentation hooks). Any other
+// outcome is left uncached.
+
+#ifndef SYZYGY_BLOCK_GRAPH_BLOCK_TRANSFORM_CACHE_H_
+#define SYZYGY_BLOCK_GRAPH_BLOCK_TRANSFORM_CACHE_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "base/strings/string_piece.h"
+#include "syzygy/block_graph/block_graph.h"
+#include "syzygy/block_graph/transform.h"
+#include "syzygy/block_graph/transform_policy.h"
+
+namespace block_graph {
+
+class BlockTransformCache {
+ public:
+  typedef std::vector<BlockGraph::Block*> BlockVector;
+
+  BlockTransformCache();
+  ~BlockTransformCache();
+
+  // Loads the cache from a file, discarding its current content. A missing
+  // file yields an empty cache, as does an unreadable or outdated one.
+  // @param path The path of the cache file.
+  // @returns true on success, false if the file exists but can't be opened.
+  bool Load(const base::FilePath& path);
+
+  // Saves the entries that were used or recorded since the cache was loaded
+  // to a file. Entries that went unused are thus dropped, so that the cache
+  // doesn't grow across runs.
+  // @param path The path of the cache file.
+  // @returns true on success, false otherwise.
+  bool Save(const base::FilePath& path) const;
+
+  // Sets the configuration of the transform that is being cached. The loaded
+  // entries are dropped if they were recorded with another configuration.
+  // This must be called prior to ApplyTransform, once per block graph.
+  // @param configuration A string that uniquely describes the behaviour of
+  //     the transform, aside from the content of the blocks it's applied to.
+  // @param external_blocks The blocks, other than those already referred to
+  //     by the original blocks, that the transformed blocks may refer to. The
+  //     order of these must be stable across runs.
+  void SetConfiguration(const base::StringPiece& configuration,
+                        const BlockVector& external_blocks);
+
+  // Applies a basic-block subgraph transform to a code block, via the cache.
+  // On a hit the block is replaced with the recorded outcome, otherwise the
+  // transform is applied as by ApplyBasicBlockSubGraphTransform and its
+  // outcome is recorded.
+  // @param transform The basic-block subgraph transform to apply.
+  // @param policy The policy object restricting how the transform is applied.
+  // @param block_graph The block-graph containing the block.
+  // @param block The code block to transform.
+  // @returns true on success, false otherwise.
+  // @pre SetConfiguration has been called.
+  bool ApplyTransform(BasicBlockSubGraphTransformInterface* transform,
+                      const TransformPolicyInterface* policy,
+                      BlockGraph* block_graph,
+                      BlockGraph::Block* block);
+
+  // @name Accessors.
+  // @{
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  size_t size() const { return entries_.size() + used_entries_.size(); }
+  const std::string& configuration() const { return configuration_; }
+  // @}
+
+  // Computes the cache key of a block. This extends the BlockHash of the
+  // block with its attributes, labels, source ranges and referrers, and with
+  // the information the basic-block decomposer relies on about its
+  // references.
+  // @param block The block to compute the key of.
+  // @returns the 16-byte key of @p block.
+  static std::string ComputeKey(const BlockGraph::Block* block);
+
+ protected:
+  // The kinds of targets of the references of a transformed block.
+  enum ReferenceKind {
+    // A reference to the transformed block itself.
+    kSelfReference,
+    // A reference to a block that the original block refers to.
+    kOriginalReference,
+    // A reference to one of the external blocks.
+    kExternalReference,
+  };
+
+  // A pair of reference offset and base.
+  typedef std::pair<int32_t, int32_t> OffsetAndBase;
+
+  // The recorded outcome of the transform of a block.
+  struct Entry {
+    Entry();
+
+    struct Label {
+      template<class OutArchive> bool Save(OutArchive* out_archive) const;
+      template<class InArchive> bool Load(InArchive* in_archive);
+
+      int32_t offset;
+      std::string name;
+      uint32_t attributes;
+    };
+
+    struct Reference {
+      template<class OutArchive> bool Save(OutArchive* out_archive) const;
+      template<class InArchive> bool Load(InArchive* in_archive);
+
+      int32_t source_offset;
+      uint32_t type;
+      uint32_t size;
+      uint8_t kind;
+      // The index of the original reference for kOriginalReference, or of the
+      // external block for kExternalReference.
+      uint32_t index;
+      // The offset and base of the reference. These are relative to those of
+      // the original reference for kOriginalReference.
+      int32_t offset;
+      int32_t base;
+    };
+
+    struct SourceRange {
+      template<class OutArchive> bool Save(OutArchive* out_archive) const;
+      template<class InArchive> bool Load(InArchive* in_archive);
+
+      int32_t data_offset;
+      uint32_t data_size;
+      // Relative to the start of the source ranges of the original block.
+      uint32_t source_offset;
+      uint32_t source_size;
+    };
+
+    template<class OutArchive> bool Save(OutArchive* out_archive) const;
+    template<class InArchive> bool Load(InArchive* in_archive);
+
+    uint32_t size;
+    std::vector<uint8_t> data;
+    uint32_t attributes;
+    uint32_t alignment;
+    int32_t alignment_offset;
+    uint32_t padding_before;
+    std::vector<Label> labels;
+    std::vector<Reference> references;
+    // Maps the offset and base of the references made to the original block
+    // by other blocks to those of the references to the new block.
+    std::map<OffsetAndBase, OffsetAndBase> referrers;
+    std::vector<SourceRange> source_ranges;
+  };
+  typedef std::map<std::string, Entry> EntryMap;
+
+  // The state of a block prior to its transform.
+  struct Snapshot {
+    // The lowest source address of the original block, or kInvalidAddress if
+    // it has no source ranges.
+    core::RelativeAddress source_base;
+    std::vector<std::pair<BlockGraph::Offset, BlockGraph::Reference>>
+        references;
+    // The references made to the block by other blocks.
+    struct Referrer {
+      BlockGraph::Block* block;
+      BlockGraph::Offset source_offset;
+      OffsetAndBase destination;
+    };
+    std::vector<Referrer> referrers;
+  };
+
+  // Takes a snapshot of a block.
+  // @param block The block to take a snapshot of.
+  // @param snapshot Receives the snapshot.
+  static void TakeSnapshot(const BlockGraph::Block* block, Snapshot* snapshot);
+
+  // Records the outcome of a transform.
+  // @param snapshot The snapshot of the original block.
+  // @param new_block The block the original block was replaced with.
+  // @param entry Receives the outcome.
+  // @returns true on success, false if the outcome can't be cached.
+  bool Record(const Snapshot& snapshot,
+              const BlockGraph::Block* new_block,
+              Entry* entry) const;
+
+  // Replaces a block with a recorded outcome.
+  // @param entry The recorded outcome.
+  // @param block_graph The block-graph containing the block.
+  // @param block The block to replace.
+  // @returns true on success, false if @p entry can't be applied to @p block,
+  //     in which case the block graph is left untouched.
+  bool Replay(const Entry& entry,
+              BlockGraph* block_graph,
+              BlockGraph::Block* block) const;
+
+  // The configuration of the transform being cached.
+  std::string configuration_;
+
+  // The external blocks of the current block graph.
+  BlockVector external_blocks_;
+
+  // Whether SetConfiguration was called.
+  bool configured_;
+
+  // The loaded entries that haven't been used yet, and those that were used
+  // or recorded since the cache was loaded.
+  EntryMap entries_;
+  EntryMap used_entries_;
+
+  // The number of blocks that were replayed and transformed, respectively.
+  size_t hits_;
+  size_t misses_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BlockTransformCache);
+};
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_BLOCK_TRANSFORM_CACHE_H_
@@ -0,0 +1,246 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/block_transform_cache.h"
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_test_util.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef BlockTransformCache::BlockVector BlockVector;
+
+// A basic-block transform that leaves the subgraphs untouched.
+class NoOpBasicBlockSubGraphTransform
+    : public BasicBlockSubGraphTransformInterface {
+ public:
+  NoOpBasicBlockSubGraphTransform() : invocations_(0) {}
+
+  const char* name() const override {
+    return "NoOpBasicBlockSubGraphTransform";
+  }
+
+  bool TransformBasicBlockSubGraph(const TransformPolicyInterface* policy,
+                                   BlockGraph* block_graph,
+                                   BasicBlockSubGraph* subgraph) override {
+    ++invocations_;
+    return true;
+  }
+
+  size_t invocations_;
+};
+
+// Holds an independent copy of the test image, standing in for a later build.
+class TestImage : public testing::BasicBlockTest {
+ public:
+  void TestBody() override {}
+};
+
+class BlockTransformCacheTest : public testing::BasicBlockTest {
+ public:
+  virtual void SetUp() override {
+    ASSERT_NO_FATAL_FAILURE(InitBlockGraph());
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    cache_path_ = temp_dir_.path().AppendASCII("cache.bin");
+  }
+
+  // @returns the only block named @p name in @p block_graph, or NULL.
+  static BlockGraph::Block* FindBlock(BlockGraph* block_graph,
+                                      const std::string& name) {
+    BlockGraph::Block* found = NULL;
+    for (auto& entry : block_graph->blocks_mutable()) {
+      if (entry.second.name() != name)
+        continue;
+      EXPECT_TRUE(found == NULL);
+      found = &entry.second;
+    }
+    return found;
+  }
+
+  // Transforms assembly_func_ via a new cache and saves the cache.
+  void TransformAndSave() {
+    BlockTransformCache cache;
+    cache.SetConfiguration("config", BlockVector());
+    NoOpBasicBlockSubGraphTransform transform;
+    ASSERT_TRUE(cache.ApplyTransform(&transform, &policy_, &block_graph_,
+                                     assembly_func_));
+    EXPECT_EQ(1u, transform.invocations_);
+    EXPECT_EQ(0u, cache.hits());
+    EXPECT_EQ(1u, cache.misses());
+    EXPECT_EQ(1u, cache.size());
+    ASSERT_TRUE(cache.Save(cache_path_));
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath cache_path_;
+};
+
+}  // namespace
+
+TEST_F(BlockTransformCacheTest, ComputeKey) {
+  std::string key = BlockTransformCache::ComputeKey(assembly_func_);
+  EXPECT_EQ(16u, key.size());
+  EXPECT_EQ(key, BlockTransformCache::ComputeKey(assembly_func_));
+
+  // An identical block in another image has the same key.
+  TestImage other;
+  ASSERT_NO_FATAL_FAILURE(other.InitBlockGraph());
+  EXPECT_EQ(key, BlockTransformCache::ComputeKey(other.assembly_func_));
+
+  // Labels matter.
+  BlockGraph::Offset offset = assembly_func_->labels().begin()->first;
+  BlockGraph::Label label = assembly_func_->labels().begin()->second;
+  label.set_attributes(label.attributes() | BlockGraph::DEBUG_START_LABEL);
+  ASSERT_TRUE(assembly_func_->RemoveLabel(offset));
+  ASSERT_TRUE(assembly_func_->SetLabel(offset, label));
+  EXPECT_NE(key, BlockTransformCache::ComputeKey(assembly_func_));
+
+  // So do the referrers.
+  BlockGraph::Block* referrer =
+      other.block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "referrer");
+  ASSERT_TRUE(referrer->SetReference(0, BlockGraph::Reference(
+      BlockGraph::ABSOLUTE_REF, 4, other.assembly_func_, 24, 24)));
+  EXPECT_NE(key, BlockTransformCache::ComputeKey(other.assembly_func_));
+}
+
+TEST_F(BlockTransformCacheTest, MissingOrInvalidFileYieldsEmptyCache) {
+  BlockTransformCache cache;
+  EXPECT_TRUE(cache.Load(cache_path_));
+  EXPECT_EQ(0u, cache.size());
+
+  static const char kGarbage[] = "not a transform cache";
+  ASSERT_EQ(static_cast<int>(sizeof(kGarbage)),
+            base::WriteFile(cache_path_, kGarbage, sizeof(kGarbage)));
+  EXPECT_TRUE(cache.Load(cache_path_));
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_TRUE(cache.configuration().empty());
+}
+
+TEST_F(BlockTransformCacheTest, ReplayMatchesTransform) {
+  ASSERT_NO_FATAL_FAILURE(TransformAndSave());
+  BlockGraph::Block* expected = FindBlock(&block_graph_, "assembly_func_");
+  ASSERT_TRUE(expected != NULL);
+
+  TestImage other;
+  ASSERT_NO_FATAL_FAILURE(other.InitBlockGraph());
+  BlockGraph::BlockId original_id = other.assembly_func_->id();
+
+  BlockTransformCache cache;
+  ASSERT_TRUE(cache.Load(cache_path_));
+  EXPECT_EQ("config", cache.configuration());
+  EXPECT_EQ(1u, cache.size());
+  cache.SetConfiguration("config", BlockVector());
+
+  NoOpBasicBlockSubGraphTransform transform;
+  ASSERT_TRUE(cache.ApplyTransform(&transform, &policy_, &other.block_graph_,
+                                   other.assembly_func_));
+  EXPECT_EQ(0u, transform.invocations_);
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(0u, cache.misses());
+
+  // The original block has been replaced.
+  EXPECT_TRUE(other.block_graph_.GetBlockById(original_id) == NULL);
+  BlockGraph::Block* replayed =
+      FindBlock(&other.block_graph_, "assembly_func_");
+  ASSERT_TRUE(replayed != NULL);
+
+  // By a block identical to the one the transform produced.
+  EXPECT_EQ(expected->size(), replayed->size());
+  ASSERT_EQ(expected->data_size(), replayed->data_size());
+  EXPECT_EQ(0, memcmp(expected->data(), replayed->data(),
+                      expected->data_size()));
+  EXPECT_EQ(expected->attributes(), replayed->attributes());
+  EXPECT_EQ(expected->alignment(), replayed->alignment());
+  EXPECT_EQ(expected->section(), replayed->section());
+  EXPECT_EQ(expected->labels(), replayed->labels());
+  EXPECT_EQ(expected->source_ranges(), replayed->source_ranges());
+
+  ASSERT_EQ(expected->references().size(), replayed->references().size());
+  auto expected_ref = expected->references().begin();
+  auto replayed_ref = replayed->references().begin();
+  for (; expected_ref != expected->references().end();
+       ++expected_ref, ++replayed_ref) {
+    EXPECT_EQ(expected_ref->first, replayed_ref->first);
+    EXPECT_EQ(expected_ref->second.type(), replayed_ref->second.type());
+    EXPECT_EQ(expected_ref->second.size(), replayed_ref->second.size());
+    EXPECT_EQ(expected_ref->second.offset(), replayed_ref->second.offset());
+    EXPECT_EQ(expected_ref->second.base(), replayed_ref->second.base());
+    if (expected_ref->second.referenced() == expected) {
+      EXPECT_EQ(replayed, replayed_ref->second.referenced());
+    } else {
+      EXPECT_EQ(expected_ref->second.referenced()->name(),
+                replayed_ref->second.referenced()->name());
+    }
+  }
+
+  // The referrers follow the new block.
+  BlockGraph::Reference expected_data_ref;
+  BlockGraph::Reference replayed_data_ref;
+  ASSERT_TRUE(data_->GetReference(0, &expected_data_ref));
+  ASSERT_TRUE(other.data_->GetReference(0, &replayed_data_ref));
+  EXPECT_EQ(replayed, replayed_data_ref.referenced());
+  EXPECT_EQ(expected_data_ref.offset(), replayed_data_ref.offset());
+  EXPECT_EQ(expected_data_ref.base(), replayed_data_ref.base());
+
+  // Only the used entries are saved.
+  ASSERT_TRUE(cache.Save(cache_path_));
+  ASSERT_TRUE(cache.Load(cache_path_));
+  EXPECT_EQ(1u, cache.size());
+}
+
+TEST_F(BlockTransformCacheTest, ConfigurationChangeEmptiesCache) {
+  ASSERT_NO_FATAL_FAILURE(TransformAndSave());
+
+  TestImage other;
+  ASSERT_NO_FATAL_FAILURE(other.InitBlockGraph());
+
+  BlockTransformCache cache;
+  ASSERT_TRUE(cache.Load(cache_path_));
+  EXPECT_EQ(1u, cache.size());
+  cache.SetConfiguration("other config", BlockVector());
+  EXPECT_EQ(0u, cache.size());
+
+  NoOpBasicBlockSubGraphTransform transform;
+  ASSERT_TRUE(cache.ApplyTransform(&transform, &policy_, &other.block_graph_,
+                                   other.assembly_func_));
+  EXPECT_EQ(1u, transform.invocations_);
+  EXPECT_EQ(0u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+}
+
+TEST_F(BlockTransformCacheTest, ModifiedBlockMisses) {
+  ASSERT_NO_FATAL_FAILURE(TransformAndSave());
+
+  TestImage other;
+  ASSERT_NO_FATAL_FAILURE(other.InitBlockGraph());
+  // Change the last entry of the case table, which ends the block.
+  size_t last = other.assembly_func_->data_size() - 1;
+  other.assembly_func_->GetMutableData()[last] ^= 0x01;
+
+  BlockTransformCache cache;
+  ASSERT_TRUE(cache.Load(cache_path_));
+  cache.SetConfiguration("config", BlockVector());
+
+  NoOpBasicBlockSubGraphTransform transform;
+  ASSERT_TRUE(cache.ApplyTransform(&transform, &policy_, &other.block_graph_,
+                                   other.assembly_func_));
+  EXPECT_EQ(0u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+}
+
+}  // namespace block_graph
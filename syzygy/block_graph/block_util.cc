@@ -189,4 +189,19 @@ bool GetJumpTableSize(const BlockGraph::Block* block,
   return true;
 }
 
+size_t CountReferences(const BlockGraph& block_graph) {
+  size_t count = 0;
+  BlockGraph::BlockMap::const_iterator it = block_graph.blocks().begin();
+  for (; it != block_graph.blocks().end(); ++it)
+    count += it->second.references().size();
+  return count;
+}
+
+void SetPhaseCounts(const BlockGraph& block_graph,
+                    core::PhaseProfiler::ScopedPhase* phase) {
+  DCHECK(phase != NULL);
+  if (phase->enabled())
+    phase->SetCounts(block_graph.blocks().size(), CountReferences(block_graph));
+}
+
 }  // namespace block_graph
@@ -20,6 +20,7 @@
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
 #include "syzygy/block_graph/block_graph.h"
+#include "syzygy/core/phase_profiler.h"
 
 namespace block_graph {
 
@@ -67,6 +68,18 @@ bool GetJumpTableSize(const block_graph::BlockGraph::Block* block,
     block_graph::BlockGraph::Block::LabelMap::const_iterator jump_table_label,
     size_t* table_size);
 
+// Counts the references held by all the blocks of a block graph.
+// @param block_graph The block graph to inspect.
+// @returns the total number of references in @p block_graph.
+size_t CountReferences(const BlockGraph& block_graph);
+
+// Records the size of a block graph with a profiled phase. This is a no-op
+// when the phase isn't being recorded.
+// @param block_graph The block graph to inspect.
+// @param phase The phase to record the size with.
+void SetPhaseCounts(const BlockGraph& block_graph,
+                    core::PhaseProfiler::ScopedPhase* phase);
+
 }  // namespace block_graph
 
 #endif  // SYZYGY_BLOCK_GRAPH_BLOCK_UTIL_H_
@@ -181,6 +181,22 @@ TEST_F(BlockUtilTest, IsUnsafeReference) {
       u2, 0, 0)));
 }
 
+TEST_F(BlockUtilTest, CountReferences) {
+  EXPECT_EQ(0u, CountReferences(image_));
+
+  BlockGraph::Block* b1 = image_.AddBlock(BlockGraph::CODE_BLOCK, 40, "b1");
+  BlockGraph::Block* b2 = image_.AddBlock(BlockGraph::DATA_BLOCK, 40, "b2");
+  EXPECT_EQ(0u, CountReferences(image_));
+
+  BlockGraph::Reference ref(BlockGraph::ABSOLUTE_REF,
+                            BlockGraph::Reference::kMaximumSize,
+                            b2, 0, 0);
+  EXPECT_TRUE(b1->SetReference(0, ref));
+  EXPECT_TRUE(b1->SetReference(4, ref));
+  EXPECT_TRUE(b2->SetReference(8, ref));
+  EXPECT_EQ(3u, CountReferences(image_));
+}
+
 TEST_F(BlockUtilTest, CheckNoUnexpectedStackFrameManipulation) {
   // Prepend some instrumentation with a conventional calling convention.
   BasicBlockAssembler assm(bb_->instructions().begin(), &bb_->instructions());
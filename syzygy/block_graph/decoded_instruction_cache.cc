@@ -0,0 +1,121 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/decoded_instruction_cache.h"
+
+#include "base/atomicops.h"
+#include "base/logging.h"
+#include "base/md5.h"
+#include "syzygy/core/disassembler_util.h"
+
+namespace block_graph {
+
+namespace {
+
+// The cache in effect. Unlike the current ParallelBasicBlockDecomposer this
+// is process-wide, as the decomposers run on worker threads. It's only ever
+// changed while no decomposition is underway.
+base::subtle::AtomicWord current_cache = 0;
+
+// @returns the key of the run decoded from @p data.
+std::string ComputeKey(const uint8_t* data, size_t size) {
+  base::MD5Digest digest = {};
+  if (size != 0)
+    base::MD5Sum(data, size, &digest);
+  return std::string(reinterpret_cast<const char*>(digest.a),
+                     sizeof(digest.a));
+}
+
+}  // namespace
+
+DecodedInstructionCache::ScopedCurrent::ScopedCurrent(
+    DecodedInstructionCache* cache)
+    : previous_(current()) {
+  DCHECK(cache != NULL);
+  base::subtle::Release_Store(
+      &current_cache, reinterpret_cast<base::subtle::AtomicWord>(cache));
+}
+
+DecodedInstructionCache::ScopedCurrent::~ScopedCurrent() {
+  base::subtle::Release_Store(
+      &current_cache, reinterpret_cast<base::subtle::AtomicWord>(previous_));
+}
+
+DecodedInstructionCache::DecodedInstructionCache() : hits_(0), misses_(0) {
+}
+
+DecodedInstructionCache::~DecodedInstructionCache() {
+  DCHECK_NE(this, current());
+}
+
+const DecodedInstructionCache::Run* DecodedInstructionCache::Decode(
+    const uint8_t* data, size_t size) {
+  DCHECK(data != NULL || size == 0);
+
+  std::string key = ComputeKey(data, size);
+  {
+    base::AutoLock auto_lock(lock_);
+    RunMap::const_iterator it = runs_.find(key);
+    if (it != runs_.end()) {
+      ++hits_;
+      return it->second.get();
+    }
+    ++misses_;
+  }
+
+  // Decode without holding the lock. Should another thread have decoded the
+  // same bytes meanwhile, its run is kept and this one is discarded.
+  std::unique_ptr<Run> run(new Run());
+  DecodeRun(data, size, run.get());
+
+  base::AutoLock auto_lock(lock_);
+  std::unique_ptr<Run>& entry = runs_[key];
+  if (entry.get() == NULL)
+    entry.swap(run);
+  return entry.get();
+}
+
+void DecodedInstructionCache::DecodeRun(const uint8_t* data,
+                                        size_t size,
+                                        Run* run) {
+  DCHECK(data != NULL || size == 0);
+  DCHECK(run != NULL);
+
+  run->instructions.clear();
+  run->size = 0;
+  if (size != 0)
+    run->size = core::DecodeInstructionRun(data, size, &run->instructions);
+}
+
+DecodedInstructionCache* DecodedInstructionCache::current() {
+  return reinterpret_cast<DecodedInstructionCache*>(
+      base::subtle::Acquire_Load(&current_cache));
+}
+
+size_t DecodedInstructionCache::hits() const {
+  base::AutoLock auto_lock(lock_);
+  return hits_;
+}
+
+size_t DecodedInstructionCache::misses() const {
+  base::AutoLock auto_lock(lock_);
+  return misses_;
+}
+
+size_t DecodedInstructionCache::size() const {
+  base::AutoLock auto_lock(lock_);
+  return runs_.size();
+}
+
+}  // namespace block_graph
@@ -0,0 +1,115 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a cache of the instructions decoded from the code bytes of blocks.
+// Each transform of a pipeline decomposes the code blocks into basic blocks
+// anew, decoding the same bytes over and over again. The cache is keyed by a
+// hash of the code bytes rather than by block, so that it keeps serving the
+// blocks that a transform leaves untouched, and those that it rebuilds with
+// identical code.
+//
+// The cache is thread-safe, so that it can be shared by the worker threads of
+// a ParallelBasicBlockDecomposer.
+
+#ifndef SYZYGY_BLOCK_GRAPH_DECODED_INSTRUCTION_CACHE_H_
+#define SYZYGY_BLOCK_GRAPH_DECODED_INSTRUCTION_CACHE_H_
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/synchronization/lock.h"
+#include "distorm.h"  // NOLINT
+
+namespace block_graph {
+
+class DecodedInstructionCache {
+ public:
+  // A linear run of decoded instructions.
+  struct Run {
+    Run() : size(0) {}
+
+    // The instructions, in order of appearance.
+    std::vector<_DInst> instructions;
+    // The number of bytes covered by the instructions. This is less than the
+    // size of the decoded buffer if decoding stopped on an invalid
+    // instruction.
+    size_t size;
+  };
+
+  // While an instance of this is alive, the basic-block decomposers on all
+  // threads decode their instructions via a given cache. This nests.
+  class ScopedCurrent {
+   public:
+    explicit ScopedCurrent(DecodedInstructionCache* cache);
+    ~ScopedCurrent();
+
+   private:
+    DecodedInstructionCache* previous_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedCurrent);
+  };
+
+  DecodedInstructionCache();
+  ~DecodedInstructionCache();
+
+  // Gets the linear run of instructions decoded from a buffer, decoding it
+  // if it isn't cached yet.
+  // @param data The code bytes to decode.
+  // @param size The number of code bytes.
+  // @returns the decoded run, which remains valid for the lifetime of the
+  //     cache.
+  const Run* Decode(const uint8_t* data, size_t size);
+
+  // Decodes the linear run of instructions of a buffer, bypassing the cache.
+  // @param data The code bytes to decode.
+  // @param size The number of code bytes.
+  // @param run Receives the decoded run.
+  static void DecodeRun(const uint8_t* data, size_t size, Run* run);
+
+  // @returns the cache the basic-block decomposers should decode via, or NULL
+  //     if there is none.
+  static DecodedInstructionCache* current();
+
+  // @name Accessors.
+  // @{
+  size_t hits() const;
+  size_t misses() const;
+  size_t size() const;
+  // @}
+
+ protected:
+  typedef std::map<std::string, std::unique_ptr<Run>> RunMap;
+
+  // Protects the members below.
+  mutable base::Lock lock_;
+
+  // The decoded runs, keyed by the MD5 digest of their code bytes.
+  RunMap runs_;
+
+  // The number of lookups that were served by the cache, and that had to
+  // decode, respectively.
+  size_t hits_;
+  size_t misses_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(DecodedInstructionCache);
+};
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_DECODED_INSTRUCTION_CACHE_H_
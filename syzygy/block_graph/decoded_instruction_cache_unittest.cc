@@ -0,0 +1,144 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/decoded_instruction_cache.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_decomposer.h"
+#include "syzygy/block_graph/basic_block_test_util.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef DecodedInstructionCache::Run Run;
+
+const uint8_t kCode[] = {
+    0x55,              // push ebp
+    0x8B, 0xEC,        // mov ebp, esp
+    0x5D,              // pop ebp
+    0xC3,              // ret
+    0xE8, 0xCA, 0xFE,  // truncated call
+};
+
+class DecodedInstructionCacheTest : public testing::BasicBlockTest {
+ public:
+  virtual void SetUp() override {
+    ASSERT_NO_FATAL_FAILURE(InitBlockGraph());
+  }
+
+  // Decomposes assembly_func_ and collects the bytes of its instructions.
+  void DecomposeAssemblyFunc(std::vector<uint8_t>* bytes) {
+    BasicBlockSubGraph subgraph;
+    BasicBlockDecomposer decomposer(assembly_func_, &subgraph);
+    ASSERT_TRUE(decomposer.Decompose());
+
+    for (const BasicBlock* bb : subgraph.basic_blocks()) {
+      const BasicCodeBlock* code_bb = BasicCodeBlock::Cast(bb);
+      if (code_bb == NULL)
+        continue;
+      for (const Instruction& instruction : code_bb->instructions()) {
+        bytes->insert(bytes->end(), instruction.data(),
+                      instruction.data() + instruction.size());
+      }
+    }
+  }
+};
+
+}  // namespace
+
+TEST_F(DecodedInstructionCacheTest, DecodeRun) {
+  Run run;
+  DecodedInstructionCache::DecodeRun(kCode, sizeof(kCode), &run);
+  ASSERT_EQ(4u, run.instructions.size());
+  EXPECT_EQ(5u, run.size);
+  EXPECT_EQ(1u, run.instructions[0].size);
+  EXPECT_EQ(2u, run.instructions[1].size);
+  EXPECT_EQ(1u, run.instructions[2].size);
+  EXPECT_EQ(1u, run.instructions[3].size);
+
+  DecodedInstructionCache::DecodeRun(kCode, 0, &run);
+  EXPECT_TRUE(run.instructions.empty());
+  EXPECT_EQ(0u, run.size);
+}
+
+TEST_F(DecodedInstructionCacheTest, DecodeIsKeyedByContent) {
+  DecodedInstructionCache cache;
+  const Run* run = cache.Decode(kCode, sizeof(kCode));
+  ASSERT_TRUE(run != NULL);
+  EXPECT_EQ(4u, run->instructions.size());
+  EXPECT_EQ(0u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+  EXPECT_EQ(1u, cache.size());
+
+  // A copy of the same bytes is served by the cache.
+  std::vector<uint8_t> copy(kCode, kCode + sizeof(kCode));
+  EXPECT_EQ(run, cache.Decode(copy.data(), copy.size()));
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+
+  // Other bytes aren't.
+  copy[1] = 0x90;
+  const Run* other_run = cache.Decode(copy.data(), copy.size());
+  EXPECT_NE(run, other_run);
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(2u, cache.misses());
+  EXPECT_EQ(2u, cache.size());
+
+  // Nor is a prefix of them.
+  EXPECT_NE(run, cache.Decode(kCode, sizeof(kCode) - 1));
+  EXPECT_EQ(3u, cache.misses());
+}
+
+TEST_F(DecodedInstructionCacheTest, ScopedCurrent) {
+  EXPECT_TRUE(DecodedInstructionCache::current() == NULL);
+  DecodedInstructionCache cache1;
+  DecodedInstructionCache cache2;
+  {
+    DecodedInstructionCache::ScopedCurrent scoped_current1(&cache1);
+    EXPECT_EQ(&cache1, DecodedInstructionCache::current());
+    {
+      DecodedInstructionCache::ScopedCurrent scoped_current2(&cache2);
+      EXPECT_EQ(&cache2, DecodedInstructionCache::current());
+    }
+    EXPECT_EQ(&cache1, DecodedInstructionCache::current());
+  }
+  EXPECT_TRUE(DecodedInstructionCache::current() == NULL);
+}
+
+TEST_F(DecodedInstructionCacheTest, DecomposerDecodesViaCurrentCache) {
+  std::vector<uint8_t> expected;
+  ASSERT_NO_FATAL_FAILURE(DecomposeAssemblyFunc(&expected));
+  ASSERT_FALSE(expected.empty());
+
+  DecodedInstructionCache cache;
+  DecodedInstructionCache::ScopedCurrent scoped_current(&cache);
+
+  std::vector<uint8_t> bytes;
+  ASSERT_NO_FATAL_FAILURE(DecomposeAssemblyFunc(&bytes));
+  EXPECT_EQ(expected, bytes);
+  EXPECT_EQ(0u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+
+  // Decomposing the block again reuses the decoded instructions.
+  bytes.clear();
+  ASSERT_NO_FATAL_FAILURE(DecomposeAssemblyFunc(&bytes));
+  EXPECT_EQ(expected, bytes);
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+}
+
+}  // namespace block_graph
@@ -16,8 +16,12 @@
 
 namespace block_graph {
 
-bool IsFiltered(const RelativeAddressFilter& filter,
-                const BlockGraph::Block* block) {
+namespace {
+
+// The implementations of IsFiltered, shared by both filter representations.
+
+template <typename FilterType>
+bool IsFilteredImpl(const FilterType& filter, const BlockGraph::Block* block) {
   DCHECK(block != NULL);
 
   // We iterate over all of the source ranges in the block. If any of them are
@@ -34,58 +38,112 @@ bool IsFiltered(const RelativeAddressFilter& filter,
   return false;
 }
 
-bool IsFiltered(const RelativeAddressFilter& filter,
-                const BasicBlock* basic_block) {
+template <typename FilterType>
+bool IsFilteredImpl(const FilterType& filter,
+                    const BasicCodeBlock* basic_block) {
+  DCHECK(basic_block != NULL);
+
+  // Iterate over all of the instructions and check their source ranges. If any
+  // of them are at all marked then the basic block is filtered.
+  BasicBlock::Instructions::const_iterator it =
+      basic_block->instructions().begin();
+  for (; it != basic_block->instructions().end(); ++it) {
+    if (!filter.IsUnmarked(it->source_range()))
+      return true;
+  }
+
+  return false;
+}
+
+template <typename FilterType>
+bool IsFilteredImpl(const FilterType& filter,
+                    const BasicDataBlock* basic_block) {
+  DCHECK(basic_block != NULL);
+
+  if (filter.IsUnmarked(basic_block->source_range()))
+    return false;
+
+  return true;
+}
+
+template <typename FilterType>
+bool IsFilteredImpl(const FilterType& filter, const BasicBlock* basic_block) {
   DCHECK(basic_block != NULL);
 
   if (basic_block->type() == BasicBlock::BASIC_DATA_BLOCK) {
     const BasicDataBlock* basic_data_block = BasicDataBlock::Cast(basic_block);
     DCHECK(basic_data_block != NULL);
-    if (!IsFiltered(filter, basic_data_block))
+    if (!IsFilteredImpl(filter, basic_data_block))
       return false;
   } else {
     DCHECK_EQ(BasicBlock::BASIC_CODE_BLOCK, basic_block->type());
     const BasicCodeBlock* basic_code_block = BasicCodeBlock::Cast(basic_block);
     DCHECK(basic_code_block != NULL);
-    if (!IsFiltered(filter, basic_code_block))
+    if (!IsFilteredImpl(filter, basic_code_block))
       return false;
   }
 
   return true;
 }
 
-bool IsFiltered(const RelativeAddressFilter& filter,
-                const BasicCodeBlock* basic_block) {
-  DCHECK(basic_block != NULL);
+template <typename FilterType>
+bool IsFilteredImpl(const FilterType& filter, const Instruction& instruction) {
+  if (filter.IsUnmarked(instruction.source_range()))
+    return false;
 
-  // Iterate over all of the instructions and check their source ranges. If any
-  // of them are at all marked then the basic block is filtered.
-  BasicBlock::Instructions::const_iterator it =
-      basic_block->instructions().begin();
-  for (; it != basic_block->instructions().end(); ++it) {
-    if (!filter.IsUnmarked(it->source_range()))
-      return true;
-  }
+  return true;
+}
 
-  return false;
+}  // namespace
+
+bool IsFiltered(const RelativeAddressFilter& filter,
+                const BlockGraph::Block* block) {
+  return IsFilteredImpl(filter, block);
 }
 
 bool IsFiltered(const RelativeAddressFilter& filter,
-                const BasicDataBlock* basic_block) {
-  DCHECK(basic_block != NULL);
+                const BasicBlock* basic_block) {
+  return IsFilteredImpl(filter, basic_block);
+}
 
-  if (filter.IsUnmarked(basic_block->source_range()))
-    return false;
+bool IsFiltered(const RelativeAddressFilter& filter,
+                const BasicCodeBlock* basic_block) {
+  return IsFilteredImpl(filter, basic_block);
+}
 
-  return true;
+bool IsFiltered(const RelativeAddressFilter& filter,
+                const BasicDataBlock* basic_block) {
+  return IsFilteredImpl(filter, basic_block);
 }
 
 bool IsFiltered(const RelativeAddressFilter& filter,
                 const Instruction& instruction) {
-  if (filter.IsUnmarked(instruction.source_range()))
-    return false;
+  return IsFilteredImpl(filter, instruction);
+}
 
-  return true;
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const BlockGraph::Block* block) {
+  return IsFilteredImpl(filter, block);
+}
+
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const BasicBlock* basic_block) {
+  return IsFilteredImpl(filter, basic_block);
+}
+
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const BasicCodeBlock* basic_block) {
+  return IsFilteredImpl(filter, basic_block);
+}
+
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const BasicDataBlock* basic_block) {
+  return IsFilteredImpl(filter, basic_block);
+}
+
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const Instruction& instruction) {
+  return IsFilteredImpl(filter, instruction);
 }
 
 }  // namespace block_graph
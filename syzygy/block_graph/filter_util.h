@@ -21,12 +21,15 @@
 
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/block_graph.h"
+#include "syzygy/core/address_bitmap_filter.h"
 #include "syzygy/core/address_filter.h"
 
 namespace block_graph {
 
 typedef core::AddressFilter<core::RelativeAddress, size_t>
     RelativeAddressFilter;
+typedef core::AddressBitmapFilter<core::RelativeAddress, size_t>
+    RelativeAddressBitmapFilter;
 
 // Determines if the given @p block is filtered. A block is filtered if any of
 // it's source data is marked in the filter.
@@ -56,6 +59,20 @@ bool IsFiltered(const RelativeAddressFilter& filter,
 bool IsFiltered(const RelativeAddressFilter& filter,
                 const block_graph::Instruction& instruction);
 
+// Equivalents of the above for a bitmap filter. These are exact if the bitmap
+// has a granularity of 1, and otherwise treat a source range as filtered if it
+// shares a granule with any marked range.
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const block_graph::BlockGraph::Block* block);
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const block_graph::BasicBlock* basic_block);
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const block_graph::BasicCodeBlock* basic_block);
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const block_graph::BasicDataBlock* basic_block);
+bool IsFiltered(const RelativeAddressBitmapFilter& filter,
+                const block_graph::Instruction& instruction);
+
 }  // namespace block_graph
 
 #endif  // SYZYGY_BLOCK_GRAPH_FILTER_UTIL_H_
@@ -18,6 +18,8 @@ namespace block_graph {
 
 bool Filterable::IsFiltered(const block_graph::BlockGraph::Block* block) const {
   DCHECK(block != NULL);
+  if (bitmap_filter_ != NULL)
+    return block_graph::IsFiltered(*bitmap_filter_, block);
   if (filter_ == NULL)
     return false;
   return block_graph::IsFiltered(*filter_, block);
@@ -25,6 +27,8 @@ bool Filterable::IsFiltered(const block_graph::BlockGraph::Block* block) const {
 
 bool Filterable::IsFiltered(const block_graph::BasicBlock* basic_block) const {
   DCHECK(basic_block != NULL);
+  if (bitmap_filter_ != NULL)
+    return block_graph::IsFiltered(*bitmap_filter_, basic_block);
   if (filter_ == NULL)
     return false;
   return block_graph::IsFiltered(*filter_, basic_block);
@@ -33,6 +37,8 @@ bool Filterable::IsFiltered(const block_graph::BasicBlock* basic_block) const {
 bool Filterable::IsFiltered(
     const block_graph::BasicCodeBlock* basic_block) const {
   DCHECK(basic_block != NULL);
+  if (bitmap_filter_ != NULL)
+    return block_graph::IsFiltered(*bitmap_filter_, basic_block);
   if (filter_ == NULL)
     return false;
   return block_graph::IsFiltered(*filter_, basic_block);
@@ -41,12 +47,16 @@ bool Filterable::IsFiltered(
 bool Filterable::IsFiltered(
     const block_graph::BasicDataBlock* basic_block) const {
   DCHECK(basic_block != NULL);
+  if (bitmap_filter_ != NULL)
+    return block_graph::IsFiltered(*bitmap_filter_, basic_block);
   if (filter_ == NULL)
     return false;
   return block_graph::IsFiltered(*filter_, basic_block);
 }
 
 bool Filterable::IsFiltered(const block_graph::Instruction& instruction) const {
+  if (bitmap_filter_ != NULL)
+    return block_graph::IsFiltered(*bitmap_filter_, instruction);
   if (filter_ == NULL)
     return false;
   return block_graph::IsFiltered(*filter_, instruction);
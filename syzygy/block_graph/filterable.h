@@ -13,7 +13,8 @@
 // limitations under the License.
 //
 // Declares a Filterable object, which can be given a RelativeAddressFilter to
-// be respected while doing its work.
+// be respected while doing its work. A RelativeAddressBitmapFilter may be
+// given in its place for constant time lookups.
 
 #ifndef SYZYGY_BLOCK_GRAPH_FILTERABLE_H_
 #define SYZYGY_BLOCK_GRAPH_FILTERABLE_H_
@@ -24,8 +25,9 @@ namespace block_graph {
 
 class Filterable {
  public:
-  Filterable() : filter_(NULL) { }
-  explicit Filterable(const RelativeAddressFilter* filter) : filter_(filter) { }
+  Filterable() : filter_(NULL), bitmap_filter_(NULL) { }
+  explicit Filterable(const RelativeAddressFilter* filter)
+      : filter_(filter), bitmap_filter_(NULL) { }
 
   // Sets the filter to be used by this object.
   // @param filter The filter to use. May be NULL.
@@ -36,10 +38,22 @@ class Filterable {
   // Returns the filter currently used by this object.
   const RelativeAddressFilter* filter() const { return filter_; }
 
+  // Sets a bitmap filter to be used by this object. This takes precedence
+  // over the filter set with set_filter.
+  // @param bitmap_filter The bitmap filter to use. May be NULL.
+  void set_bitmap_filter(const RelativeAddressBitmapFilter* bitmap_filter) {
+    bitmap_filter_ = bitmap_filter;
+  }
+
+  // Returns the bitmap filter currently used by this object.
+  const RelativeAddressBitmapFilter* bitmap_filter() const {
+    return bitmap_filter_;
+  }
+
   // Determines if the given object is filtered.
   // @param basic_block The basic block to be checked.
   // @returns true if the object filtered, false otherwise.
-  // @note If no filter is specified this always returns false.
+  // @note If neither filter is specified this always returns false.
   bool IsFiltered(const block_graph::BlockGraph::Block* block) const;
   bool IsFiltered(const block_graph::BasicBlock* basic_block) const;
   bool IsFiltered(const block_graph::BasicCodeBlock* basic_block) const;
@@ -48,6 +62,7 @@ class Filterable {
 
  private:
   const RelativeAddressFilter* filter_;
+  const RelativeAddressBitmapFilter* bitmap_filter_;
 
   DISALLOW_COPY_AND_ASSIGN(Filterable);
 };
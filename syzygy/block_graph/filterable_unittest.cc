@@ -47,6 +47,13 @@ TEST(FilterableTest, Accessors)  {
 
   f.set_filter(NULL);
   EXPECT_TRUE(f.filter() == NULL);
+
+  RelativeAddressBitmapFilter rabf;
+  f.set_bitmap_filter(&rabf);
+  EXPECT_EQ(&rabf, f.bitmap_filter());
+
+  f.set_bitmap_filter(NULL);
+  EXPECT_TRUE(f.bitmap_filter() == NULL);
 }
 
 TEST(FilterableTest, IsFiltered) {
@@ -116,4 +123,42 @@ TEST(FilterableTest, IsFiltered) {
   EXPECT_TRUE(f.IsFiltered(inst));
 }
 
+TEST(FilterableTest, IsFilteredWithBitmapFilter) {
+  Filterable f;
+
+  BlockGraph block_graph;
+  BlockGraph::Block* block =
+      block_graph.AddBlock(BlockGraph::CODE_BLOCK, 10, "block");
+  EXPECT_TRUE(block->source_ranges().Push(
+        BlockGraph::Block::SourceRanges::SourceRange(0, 10),
+        BlockGraph::Block::SourceRanges::DestinationRange(
+            RelativeAddress(35), 10)));
+  Instruction inst;
+  EXPECT_TRUE(Instruction::FromBuffer(testing::kNop1,
+                                      arraysize(testing::kNop1), &inst));
+  inst.set_source_range(
+      Range(RelativeAddress(32), arraysize(testing::kNop1)));
+
+  // The range filter marks the block, but the bitmap filter takes precedence.
+  RelativeAddressFilter raf(Range(RelativeAddress(0), 100));
+  raf.Mark(Range(RelativeAddress(30), 10));
+  f.set_filter(&raf);
+  EXPECT_TRUE(f.IsFiltered(block));
+  EXPECT_TRUE(f.IsFiltered(inst));
+
+  RelativeAddressBitmapFilter rabf(Range(RelativeAddress(0), 100), 1);
+  f.set_bitmap_filter(&rabf);
+  EXPECT_FALSE(f.IsFiltered(block));
+  EXPECT_FALSE(f.IsFiltered(inst));
+
+  rabf.Mark(Range(RelativeAddress(44), 1));
+  EXPECT_TRUE(f.IsFiltered(block));
+  EXPECT_FALSE(f.IsFiltered(inst));
+
+  // A bitmap built from the range filter agrees with it.
+  rabf = RelativeAddressBitmapFilter(raf, 1);
+  EXPECT_TRUE(f.IsFiltered(block));
+  EXPECT_TRUE(f.IsFiltered(inst));
+}
+
 }  // namespace block_graph
@@ -14,6 +14,8 @@
 
 #include "syzygy/block_graph/iterate.h"
 
+#include <algorithm>
+
 namespace block_graph {
 
 bool IterateBlockGraph(const IterationCallback& callback,
@@ -54,4 +56,63 @@ bool IterateBlockGraph(const IterationCallback& callback,
   return true;
 }
 
+DeferredMutations::DeferredMutations() {
+}
+
+DeferredMutations::~DeferredMutations() {
+}
+
+void DeferredMutations::Add(const Mutation& mutation) {
+  DCHECK(!mutation.is_null());
+  mutations_.push_back(mutation);
+}
+
+bool DeferredMutations::Apply(BlockGraph* block_graph) const {
+  DCHECK(block_graph != NULL);
+
+  for (const auto& mutation : mutations_) {
+    if (!mutation.Run(block_graph))
+      return false;
+  }
+
+  return true;
+}
+
+namespace internal {
+
+void PartitionBlocksBySize(const std::vector<const BlockGraph::Block*>& blocks,
+                           size_t num_ranges,
+                           std::vector<size_t>* range_ends) {
+  DCHECK_LT(0u, num_ranges);
+  DCHECK(range_ends != NULL);
+
+  range_ends->clear();
+  if (blocks.empty())
+    return;
+
+  // Empty blocks still cost a callback, so count them as one byte.
+  uint64_t total_size = 0;
+  for (const auto* block : blocks)
+    total_size += std::max<BlockGraph::Size>(block->size(), 1);
+
+  // Close a range each time the running size crosses the next multiple of
+  // the target size.
+  num_ranges = std::min(num_ranges, blocks.size());
+  uint64_t running_size = 0;
+  size_t range = 1;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    running_size += std::max<BlockGraph::Size>(blocks[i]->size(), 1);
+    if (running_size * num_ranges >= total_size * range) {
+      range_ends->push_back(i + 1);
+      while (range < num_ranges &&
+             running_size * num_ranges >= total_size * range) {
+        ++range;
+      }
+    }
+  }
+  DCHECK_EQ(blocks.size(), range_ends->back());
+}
+
+}  // namespace internal
+
 }  // namespace block_graph
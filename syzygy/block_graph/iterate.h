@@ -18,6 +18,8 @@
 #ifndef SYZYGY_BLOCK_GRAPH_ITERATE_H_
 #define SYZYGY_BLOCK_GRAPH_ITERATE_H_
 
+#include <vector>
+
 #include "base/callback.h"
 #include "syzygy/block_graph/block_graph.h"
 
@@ -47,6 +49,77 @@ typedef base::Callback<bool(BlockGraph* block_graph,
 bool IterateBlockGraph(const IterationCallback& callback,
                        BlockGraph* block_graph);
 
+// Holds the modifications of the block-graph requested by a callback of
+// ParallelIterateBlockGraph. These are applied serially once every block has
+// been visited.
+class DeferredMutations {
+ public:
+  // The type of a deferred modification of the block-graph.
+  typedef base::Callback<bool(BlockGraph* block_graph)> Mutation;
+
+  DeferredMutations();
+  ~DeferredMutations();
+
+  // Queues a mutation.
+  // @param mutation The mutation to apply after the iteration.
+  void Add(const Mutation& mutation);
+
+  // @returns the number of queued mutations.
+  size_t size() const { return mutations_.size(); }
+
+  // Applies the queued mutations, in the order they were added.
+  // @param block_graph The block-graph to modify.
+  // @returns true on success, false if a mutation failed. The remaining
+  //     mutations aren't applied in that case.
+  bool Apply(BlockGraph* block_graph) const;
+
+ private:
+  std::vector<Mutation> mutations_;
+};
+
+// The type of callback used by the ParallelIterateBlockGraph function. The
+// callback receives the block to handle, the scratch state of the worker
+// handling it and the queue of mutations for that block.
+template <typename ScratchType>
+using ParallelIterationCallback =
+    base::Callback<bool(const BlockGraph& block_graph,
+                        const BlockGraph::Block& block,
+                        ScratchType* scratch,
+                        DeferredMutations* mutations)>;
+
+// A parallel counterpart of IterateBlockGraph, for transforms that spend most
+// of their time inspecting blocks rather than modifying them.
+//
+// The pre-existing blocks are split into contiguous ranges of roughly equal
+// total size, which are handed out to a pool of workers. The callback may be
+// invoked concurrently for different blocks, and must not modify the
+// block-graph or any block: it may only read them, update the scratch state of
+// its worker and queue mutations. Once every block has been visited, the
+// mutations are applied serially in the order of the blocks that queued them,
+// so the outcome doesn't depend on the number of workers or on the
+// scheduling. A mutation may add or remove blocks, so mutations looking up a
+// block that an earlier mutation may have removed should refer to it by ID.
+//
+// No mutation is applied if the callback fails for any block.
+//
+// @tparam ScratchType The per-worker scratch state. Must be default
+//     constructible and copyable.
+// @param callback The callback to invoke for each pre-existing block.
+// @param num_threads The maximum number of workers to use. A single worker
+//     runs on the calling thread.
+// @param block_graph The block-graph to iterate over.
+// @param scratches Receives the scratch state of each worker, for the caller
+//     to merge.
+// @returns true on success, false otherwise.
+template <typename ScratchType>
+bool ParallelIterateBlockGraph(
+    const ParallelIterationCallback<ScratchType>& callback,
+    size_t num_threads,
+    BlockGraph* block_graph,
+    std::vector<ScratchType>* scratches);
+
 }  // namespace block_graph
 
+#include "syzygy/block_graph/iterate_impl.h"
+
 #endif  // SYZYGY_BLOCK_GRAPH_ITERATE_H_
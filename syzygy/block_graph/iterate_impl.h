@@ -0,0 +1,180 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation details for iterate.h. Not meant to be included
+// directly.
+
+#ifndef SYZYGY_BLOCK_GRAPH_ITERATE_IMPL_H_
+#define SYZYGY_BLOCK_GRAPH_ITERATE_IMPL_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/logging.h"
+#include "base/threading/simple_thread.h"
+
+namespace block_graph {
+
+namespace internal {
+
+// The number of block ranges handed out per worker, so that a worker that
+// finishes early can pick up some of the remaining work.
+const size_t kBlockRangesPerWorker = 4;
+
+// Splits a sequence of blocks into contiguous ranges of roughly equal total
+// size.
+// @param blocks The blocks to split.
+// @param num_ranges The number of ranges to aim for. Must be non-zero.
+// @param range_ends Receives the end index of each range, in increasing
+//     order. The last one is blocks.size(). Empty ranges are never produced.
+void PartitionBlocksBySize(const std::vector<const BlockGraph::Block*>& blocks,
+                           size_t num_ranges,
+                           std::vector<size_t>* range_ends);
+
+// The work done by each worker of ParallelIterateBlockGraph. Each run is a
+// worker, which claims the next range of blocks that no worker has claimed
+// yet until there are none left.
+template <typename ScratchType>
+class ParallelIterationWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  ParallelIterationWork(const ParallelIterationCallback<ScratchType>& callback,
+                        const BlockGraph* block_graph,
+                        const std::vector<const BlockGraph::Block*>* blocks,
+                        const std::vector<size_t>* range_ends,
+                        std::vector<ScratchType>* scratches,
+                        std::vector<DeferredMutations>* mutations)
+      : callback_(callback),
+        block_graph_(block_graph),
+        blocks_(blocks),
+        range_ends_(range_ends),
+        scratches_(scratches),
+        mutations_(mutations),
+        next_worker_(0),
+        next_range_(0),
+        failed_(0) {
+    DCHECK(block_graph != NULL);
+    DCHECK(blocks != NULL);
+    DCHECK(range_ends != NULL);
+    DCHECK(scratches != NULL);
+    DCHECK(mutations != NULL);
+    DCHECK_EQ(blocks->size(), mutations->size());
+  }
+
+  // @returns true if the callback failed for any of the blocks.
+  bool failed() const { return base::subtle::Acquire_Load(&failed_) != 0; }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t worker = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_worker_, 1) - 1);
+    DCHECK_LT(worker, scratches_->size());
+    ScratchType* scratch = &scratches_->at(worker);
+
+    while (!failed()) {
+      size_t range = static_cast<size_t>(
+          base::subtle::NoBarrier_AtomicIncrement(&next_range_, 1) - 1);
+      if (range >= range_ends_->size())
+        return;
+
+      size_t begin = range == 0 ? 0 : range_ends_->at(range - 1);
+      size_t end = range_ends_->at(range);
+      for (size_t i = begin; i < end; ++i) {
+        const BlockGraph::Block* block = blocks_->at(i);
+        if (!callback_.Run(*block_graph_, *block, scratch,
+                           &mutations_->at(i))) {
+          LOG(ERROR) << "ParallelIterateBlockGraph callback failed for block "
+                     << "\"" << block->name() << "\".";
+          base::subtle::Release_Store(&failed_, 1);
+          return;
+        }
+      }
+    }
+  }
+  // @}
+
+ private:
+  const ParallelIterationCallback<ScratchType>& callback_;
+  const BlockGraph* block_graph_;
+  const std::vector<const BlockGraph::Block*>* blocks_;
+  const std::vector<size_t>* range_ends_;
+  std::vector<ScratchType>* scratches_;
+  std::vector<DeferredMutations>* mutations_;
+  base::subtle::Atomic32 next_worker_;
+  base::subtle::Atomic32 next_range_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelIterationWork);
+};
+
+}  // namespace internal
+
+template <typename ScratchType>
+bool ParallelIterateBlockGraph(
+    const ParallelIterationCallback<ScratchType>& callback,
+    size_t num_threads,
+    BlockGraph* block_graph,
+    std::vector<ScratchType>* scratches) {
+  DCHECK_LT(0u, num_threads);
+  DCHECK(block_graph != NULL);
+  DCHECK(scratches != NULL);
+
+  scratches->clear();
+
+  // Take a snapshot of the pre-existing blocks, in iteration order.
+  std::vector<const BlockGraph::Block*> blocks;
+  blocks.reserve(block_graph->blocks().size());
+  for (const auto& entry : block_graph->blocks())
+    blocks.push_back(&entry.second);
+  if (blocks.empty())
+    return true;
+
+  std::vector<size_t> range_ends;
+  internal::PartitionBlocksBySize(
+      blocks, num_threads * internal::kBlockRangesPerWorker, &range_ends);
+  size_t num_workers = std::min(num_threads, range_ends.size());
+  scratches->resize(num_workers);
+
+  std::vector<DeferredMutations> mutations(blocks.size());
+  internal::ParallelIterationWork<ScratchType> work(
+      callback, block_graph, &blocks, &range_ends, scratches, &mutations);
+  if (num_workers == 1) {
+    work.Run();
+  } else {
+    base::DelegateSimpleThreadPool pool("ParallelIterateBlockGraph",
+                                        static_cast<int>(num_workers));
+    pool.Start();
+    pool.AddWork(&work, static_cast<int>(num_workers));
+    pool.JoinAll();
+  }
+  if (work.failed())
+    return false;
+
+  // Apply the mutations in block order, so that the outcome is the same
+  // however the blocks were distributed.
+  for (size_t i = 0; i < mutations.size(); ++i) {
+    if (!mutations[i].Apply(block_graph)) {
+      LOG(ERROR) << "Failed to apply the mutations deferred by a parallel "
+                 << "iteration.";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_ITERATE_IMPL_H_
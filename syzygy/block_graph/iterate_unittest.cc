@@ -16,6 +16,9 @@
 
 #include "syzygy/block_graph/iterate.h"
 
+#include <set>
+#include <vector>
+
 #include "base/bind.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -68,6 +71,51 @@ class MockIterationCallback {
   }
 };
 
+// The scratch state of the parallel iteration tests.
+struct VisitScratch {
+  VisitScratch() : total_size(0) {}
+
+  std::vector<BlockGraph::BlockId> visited;
+  size_t total_size;
+};
+
+bool VisitBlock(const BlockGraph& block_graph,
+                const BlockGraph::Block& block,
+                VisitScratch* scratch,
+                DeferredMutations* mutations) {
+  scratch->visited.push_back(block.id());
+  scratch->total_size += block.size();
+  return true;
+}
+
+bool AddBlockAfterIteration(BlockGraph::BlockId id, BlockGraph* block_graph) {
+  BlockGraph::Block* block = block_graph->GetBlockById(id);
+  if (block == NULL)
+    return false;
+  return block_graph->AddBlock(block->type(), 10, "New block") != NULL;
+}
+
+bool DeferAddBlock(size_t expected_block_count,
+                   const BlockGraph& block_graph,
+                   const BlockGraph::Block& block,
+                   VisitScratch* scratch,
+                   DeferredMutations* mutations) {
+  // The block-graph is left untouched while iterating.
+  if (block_graph.blocks().size() != expected_block_count)
+    return false;
+  mutations->Add(base::Bind(&AddBlockAfterIteration, block.id()));
+  return true;
+}
+
+bool FailOnBlock(BlockGraph::BlockId failing_id,
+                 const BlockGraph& block_graph,
+                 const BlockGraph::Block& block,
+                 VisitScratch* scratch,
+                 DeferredMutations* mutations) {
+  mutations->Add(base::Bind(&AddBlockAfterIteration, block.id()));
+  return block.id() != failing_id;
+}
+
 }  // namespace
 
 TEST_F(IterationTest, Iterate) {
@@ -128,4 +176,87 @@ TEST_F(IterationTest, IterateDeleteAdd) {
   EXPECT_EQ(3u, block_graph_.blocks().size());
 }
 
+TEST(PartitionBlocksBySizeTest, Partition) {
+  BlockGraph block_graph;
+  std::vector<const BlockGraph::Block*> blocks;
+  std::vector<size_t> range_ends;
+
+  internal::PartitionBlocksBySize(blocks, 4, &range_ends);
+  EXPECT_TRUE(range_ends.empty());
+
+  // One large block followed by many small ones.
+  blocks.push_back(block_graph.AddBlock(BlockGraph::CODE_BLOCK, 100, "Big"));
+  for (size_t i = 0; i < 10; ++i) {
+    blocks.push_back(
+        block_graph.AddBlock(BlockGraph::CODE_BLOCK, 10, "Small"));
+  }
+
+  internal::PartitionBlocksBySize(blocks, 1, &range_ends);
+  EXPECT_THAT(range_ends, testing::ElementsAre(11));
+
+  internal::PartitionBlocksBySize(blocks, 2, &range_ends);
+  EXPECT_THAT(range_ends, testing::ElementsAre(1, 11));
+
+  internal::PartitionBlocksBySize(blocks, 4, &range_ends);
+  EXPECT_THAT(range_ends, testing::ElementsAre(1, 6, 11));
+
+  // There are never more ranges than blocks.
+  internal::PartitionBlocksBySize(blocks, 100, &range_ends);
+  EXPECT_GE(11u, range_ends.size());
+  EXPECT_EQ(11u, range_ends.back());
+}
+
+TEST_F(IterationTest, ParallelIterate) {
+  std::vector<VisitScratch> scratches;
+  EXPECT_TRUE(ParallelIterateBlockGraph(base::Bind(&VisitBlock), 1,
+                                        &block_graph_, &scratches));
+  ASSERT_EQ(1u, scratches.size());
+  EXPECT_EQ(3u, scratches[0].visited.size());
+  EXPECT_EQ(30u, scratches[0].total_size);
+  EXPECT_EQ(3u, block_graph_.blocks().size());
+}
+
+TEST_F(IterationTest, ParallelIterateManyBlocks) {
+  for (size_t i = 0; i < 1000; ++i) {
+    block_graph_.AddBlock(BlockGraph::CODE_BLOCK, i % 97, "Function");
+  }
+
+  std::vector<VisitScratch> scratches;
+  EXPECT_TRUE(ParallelIterateBlockGraph(base::Bind(&VisitBlock), 4,
+                                        &block_graph_, &scratches));
+  EXPECT_LT(0u, scratches.size());
+  EXPECT_GE(4u, scratches.size());
+
+  // Each block is visited exactly once.
+  std::set<BlockGraph::BlockId> visited;
+  size_t total_size = 0;
+  for (const auto& scratch : scratches) {
+    for (BlockGraph::BlockId id : scratch.visited)
+      EXPECT_TRUE(visited.insert(id).second);
+    total_size += scratch.total_size;
+  }
+  EXPECT_EQ(block_graph_.blocks().size(), visited.size());
+
+  size_t expected_total_size = 0;
+  for (const auto& entry : block_graph_.blocks())
+    expected_total_size += entry.second.size();
+  EXPECT_EQ(expected_total_size, total_size);
+}
+
+TEST_F(IterationTest, ParallelIterateDefersMutations) {
+  std::vector<VisitScratch> scratches;
+  EXPECT_TRUE(ParallelIterateBlockGraph(
+      base::Bind(&DeferAddBlock, block_graph_.blocks().size()), 2,
+      &block_graph_, &scratches));
+  EXPECT_EQ(6u, block_graph_.blocks().size());
+}
+
+TEST_F(IterationTest, ParallelIterateFailsWithoutMutating) {
+  std::vector<VisitScratch> scratches;
+  EXPECT_FALSE(ParallelIterateBlockGraph(
+      base::Bind(&FailOnBlock, header_block_->id()), 2, &block_graph_,
+      &scratches));
+  EXPECT_EQ(3u, block_graph_.blocks().size());
+}
+
 }  // namespace block_graph
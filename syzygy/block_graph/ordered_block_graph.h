@@ -19,8 +19,9 @@
 //
 // The structure maintains all sections in a list, and for each section
 // maintains a list of blocks within that section. Utility functions are
-// provided that allow for sections and blocks to be moved individually, or for
-// all sections/all blocks in a section to be sorted wholesale.
+// provided that allow for sections and blocks to be moved individually, for
+// all sections/all blocks in a section to be sorted wholesale, or for a
+// complete order to be applied to a section in a single pass.
 //
 // In general, it is intended to be used as follows:
 //
@@ -211,12 +212,24 @@ class OrderedBlockGraph {
   template<typename BlockCompareFunctor>
   void Sort(const Section* section, BlockCompareFunctor block_compare_functor);
 
+  // Places the given blocks at the head of the given section, in the given
+  // order. Blocks that do not belong to that section will have their
+  // section_id updated. The blocks already in the section that are not in
+  // @p blocks follow them, in their current relative order. This runs in time
+  // linear in the size of @p blocks, and is the preferred way of applying a
+  // complete order to a section.
+  //
+  // @param section the section into which the blocks should be placed. May be
+  //     NULL, indicating that the blocks lie outside of all known sections.
+  // @param blocks the blocks to be placed, in order.
+  // @pre @p blocks contains no duplicates.
+  void SetOrder(const Section* section, const BlockVector& blocks);
+
  protected:
   // Forward declarations.
   struct SectionInfo;
   struct BlockInfo;
   struct CompareSectionInfo;
-  struct CompareBlockInfo;
 
   // @{
   // @returns the SectionInfo representing the given Section*.
@@ -244,9 +257,10 @@ class OrderedBlockGraph {
   std::vector<SectionInfo> section_infos_;
   // Stores a full set of iterators pointing to all of the blocks in the various
   // OrderedSection BlockLists. This is allocated once and reused. The entries
-  // are sorted based on the block pointers referred to by the iterators. In
-  // this way we can do a fast lookup from Block* to the BlockList containing
-  // it, as well as the iterator to it.
+  // are indexed by block ID, so that we can do a constant time lookup from
+  // Block* to the BlockList containing it, as well as the iterator to it. The
+  // entries of IDs that don't correspond to a block have a NULL
+  // ordered_section.
   std::vector<BlockInfo> block_infos_;
 
   DISALLOW_COPY_AND_ASSIGN(OrderedBlockGraph);
@@ -418,4 +418,54 @@ TEST_F(OrderedBlockGraphTest, BlockSort) {
   EXPECT_TRUE(ordered.IndicesAreValid());
 }
 
+TEST_F(OrderedBlockGraphTest, BlockSetOrder) {
+  InitBlockGraph(2, 4, 0);
+  TestOrderedBlockGraph ordered(&block_graph_);
+  EXPECT_SECTION_CONTAINS(ordered, 0, 1, 2, 3, 4);
+  EXPECT_SECTION_CONTAINS(ordered, 1, 5, 6, 7, 8);
+  BlockGraph::Section* section0 = block_graph_.GetSectionById(0);
+
+  // An empty order is a noop.
+  ordered.SetOrder(section0, BlockVector());
+  EXPECT_SECTION_CONTAINS(ordered, 0, 1, 2, 3, 4);
+  EXPECT_TRUE(ordered.IndicesAreValid());
+
+  // Blocks already in place stay put, the others are moved in front of the
+  // remaining ones. Blocks from other sections are moved over.
+  BlockVector blocks;
+  blocks.push_back(block_graph_.GetBlockById(1));
+  blocks.push_back(block_graph_.GetBlockById(7));
+  blocks.push_back(block_graph_.GetBlockById(4));
+  blocks.push_back(block_graph_.GetBlockById(2));
+  ordered.SetOrder(section0, blocks);
+  EXPECT_SECTION_CONTAINS(ordered, 0, 1, 7, 4, 2, 3);
+  EXPECT_SECTION_CONTAINS(ordered, 1, 5, 6, 8);
+  EXPECT_EQ(0, block_graph_.GetBlockById(7)->section());
+  EXPECT_TRUE(ordered.IndicesAreValid());
+
+  // A complete order replaces the current one.
+  blocks.clear();
+  blocks.push_back(block_graph_.GetBlockById(3));
+  blocks.push_back(block_graph_.GetBlockById(2));
+  blocks.push_back(block_graph_.GetBlockById(1));
+  blocks.push_back(block_graph_.GetBlockById(4));
+  blocks.push_back(block_graph_.GetBlockById(7));
+  ordered.SetOrder(section0, blocks);
+  EXPECT_SECTION_CONTAINS(ordered, 0, 3, 2, 1, 4, 7);
+  EXPECT_TRUE(ordered.IndicesAreValid());
+}
+
+TEST_F(OrderedBlockGraphTest, BlockIndexWithIdGaps) {
+  InitBlockGraph(0, 0, 4);
+  ASSERT_TRUE(block_graph_.RemoveBlockById(2));
+  TestOrderedBlockGraph ordered(&block_graph_);
+  EXPECT_SECTION_CONTAINS(ordered, NULL, 1, 3, 4);
+
+  BlockVector blocks;
+  blocks.push_back(block_graph_.GetBlockById(4));
+  ordered.SetOrder(NULL, blocks);
+  EXPECT_SECTION_CONTAINS(ordered, NULL, 4, 1, 3);
+  EXPECT_TRUE(ordered.IndicesAreValid());
+}
+
 }  // namespace block_graph
@@ -0,0 +1,250 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/parallel_basic_block_decomposer.h"
+
+#include <algorithm>
+#include <set>
+
+#include "base/atomicops.h"
+#include "base/lazy_instance.h"
+#include "base/logging.h"
+#include "base/threading/simple_thread.h"
+#include "base/threading/thread_local.h"
+#include "syzygy/block_graph/basic_block_decomposer.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef ParallelBasicBlockDecomposer::BlockVector BlockVector;
+typedef ParallelBasicBlockDecomposer::Decomposition Decomposition;
+
+// The maximum number of blocks in a batch. This bounds the number of
+// subgraphs alive at any given time.
+const size_t kMaxBatchSize = 1024;
+
+// Moves a decomposition from @p from to @p to.
+void TransferDecomposition(Decomposition* from, Decomposition* to) {
+  DCHECK(from != NULL);
+  DCHECK(to != NULL);
+  to->subgraph.reset(from->subgraph.release());
+  to->contains_unsupported_instructions =
+      from->contains_unsupported_instructions;
+}
+
+// The work shared by the worker threads. Each run decomposes the next block
+// that no thread has claimed yet.
+class DecompositionWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  DecompositionWork(const BlockVector& blocks,
+                    std::vector<Decomposition>* decompositions)
+      : blocks_(blocks), decompositions_(decompositions), next_index_(0) {
+    DCHECK(decompositions != NULL);
+    DCHECK_EQ(blocks.size(), decompositions->size());
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, blocks_.size());
+    ParallelBasicBlockDecomposer::DecomposeBlock(blocks_[index],
+                                                 &(*decompositions_)[index]);
+  }
+  // @}
+
+ private:
+  const BlockVector& blocks_;
+  std::vector<Decomposition>* decompositions_;
+  base::subtle::Atomic32 next_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecompositionWork);
+};
+
+// The decomposer in effect on each thread, if any. Several block graphs may
+// be transformed concurrently, each on its own thread.
+base::LazyInstance<base::ThreadLocalPointer<ParallelBasicBlockDecomposer>>::
+    Leaky current_decomposer = LAZY_INSTANCE_INITIALIZER;
+
+}  // namespace
+
+ParallelBasicBlockDecomposer::ScopedCurrent::ScopedCurrent(
+    ParallelBasicBlockDecomposer* decomposer)
+    : previous_(current()) {
+  DCHECK(decomposer != NULL);
+  current_decomposer.Get().Set(decomposer);
+}
+
+ParallelBasicBlockDecomposer::ScopedCurrent::~ScopedCurrent() {
+  current_decomposer.Get().Set(previous_);
+}
+
+ParallelBasicBlockDecomposer::ParallelBasicBlockDecomposer(size_t num_threads)
+    : num_threads_(num_threads) {
+  DCHECK_LT(0U, num_threads);
+}
+
+ParallelBasicBlockDecomposer::~ParallelBasicBlockDecomposer() {
+  DCHECK_NE(this, current());
+}
+
+ParallelBasicBlockDecomposer* ParallelBasicBlockDecomposer::current() {
+  return current_decomposer.Get().Get();
+}
+
+void ParallelBasicBlockDecomposer::Decompose(const BlockVector& blocks) {
+  snapshots_.clear();
+  if (blocks.empty())
+    return;
+
+  std::vector<Decomposition> decompositions(blocks.size());
+  if (num_threads_ == 1 || blocks.size() == 1) {
+    for (size_t i = 0; i < blocks.size(); ++i)
+      DecomposeBlock(blocks[i], &decompositions[i]);
+  } else {
+    DecompositionWork work(blocks, &decompositions);
+    base::DelegateSimpleThreadPool pool(
+        "BasicBlockDecomposer",
+        static_cast<int>(std::min(num_threads_, blocks.size())));
+    pool.Start();
+    pool.AddWork(&work, static_cast<int>(blocks.size()));
+    pool.JoinAll();
+  }
+
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const BlockGraph::Block* block = blocks[i];
+    DCHECK_EQ(BlockGraph::CODE_BLOCK, block->type());
+    Snapshot& snapshot = snapshots_[block->id()];
+    TransferDecomposition(&decompositions[i], &snapshot.decomposition);
+    snapshot.references = block->references();
+    snapshot.referrers = block->referrers();
+    snapshot.size = block->size();
+  }
+  DCHECK_EQ(blocks.size(), snapshots_.size());
+}
+
+void ParallelBasicBlockDecomposer::DecomposeBlock(
+    const BlockGraph::Block* block,
+    Decomposition* decomposition) {
+  DCHECK(block != NULL);
+  DCHECK(decomposition != NULL);
+
+  std::unique_ptr<BasicBlockSubGraph> subgraph(new BasicBlockSubGraph());
+  BasicBlockDecomposer bb_decomposer(block, subgraph.get());
+  if (bb_decomposer.Decompose()) {
+    decomposition->subgraph.reset(subgraph.release());
+    return;
+  }
+  decomposition->contains_unsupported_instructions =
+      bb_decomposer.contains_unsupported_instructions();
+}
+
+bool ParallelBasicBlockDecomposer::TakeDecomposition(
+    const BlockGraph::Block* block,
+    Decomposition* decomposition) {
+  DCHECK(block != NULL);
+  DCHECK(decomposition != NULL);
+
+  SnapshotMap::iterator it = snapshots_.find(block->id());
+  if (it == snapshots_.end())
+    return false;
+
+  // The block may have been modified by the callback of one of its neighbours
+  // since it was decomposed, in which case the subgraph no longer describes it.
+  const Snapshot& snapshot = it->second;
+  bool unchanged = snapshot.size == block->size() &&
+                   snapshot.references == block->references() &&
+                   snapshot.referrers == block->referrers();
+  if (unchanged)
+    TransferDecomposition(&it->second.decomposition, decomposition);
+  snapshots_.erase(it);
+  return unchanged;
+}
+
+bool IterateBlockGraphWithParallelDecomposition(
+    const IterationCallback& callback,
+    const TransformPolicyInterface* policy,
+    size_t num_threads,
+    BlockGraph* block_graph) {
+  DCHECK(policy != NULL);
+  DCHECK_LT(0U, num_threads);
+  DCHECK(block_graph != NULL);
+
+  if (block_graph->blocks().size() == 0)
+    return true;
+
+  // Get the ID of the last existing block in iterator order.
+  BlockGraph::BlockMap::iterator last_block_it =
+      block_graph->blocks_mutable().end();
+  --last_block_it;
+  BlockGraph::BlockId last_block_id = last_block_it->second.id();
+
+  ParallelBasicBlockDecomposer decomposer(num_threads);
+  ParallelBasicBlockDecomposer::ScopedCurrent scoped_current(&decomposer);
+
+  BlockGraph::BlockMap::iterator block_it =
+      block_graph->blocks_mutable().begin();
+  bool last_batch = false;
+  while (!last_batch) {
+    // Gather a batch of consecutive blocks, none of which is a neighbour of
+    // another.
+    std::vector<BlockGraph::BlockId> batch;
+    BlockVector code_blocks;
+    std::set<const BlockGraph::Block*> neighbours;
+    while (batch.size() < kMaxBatchSize) {
+      BlockGraph::Block* block = &block_it->second;
+      if (neighbours.count(block) != 0)
+        break;
+
+      batch.push_back(block->id());
+      for (const auto& ref : block->references())
+        neighbours.insert(ref.second.referenced());
+      for (const auto& referrer : block->referrers())
+        neighbours.insert(referrer.first);
+
+      if (block->type() == BlockGraph::CODE_BLOCK &&
+          policy->BlockIsSafeToBasicBlockDecompose(block)) {
+        code_blocks.push_back(block);
+      }
+
+      // Advance prior to invoking the callbacks, as they're allowed to delete
+      // the blocks of the batch.
+      ++block_it;
+      if (block->id() == last_block_id) {
+        last_batch = true;
+        break;
+      }
+    }
+
+    decomposer.Decompose(code_blocks);
+
+    for (BlockGraph::BlockId id : batch) {
+      // Each block can only be deleted by its own callback, so it is still
+      // around.
+      BlockGraph::Block* block = block_graph->GetBlockById(id);
+      DCHECK(block != NULL);
+      if (!callback.Run(block_graph, block)) {
+        LOG(ERROR) << "IterateBlocks callback failed for block "
+                   << "\"" << block->name() << "\".";
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace block_graph
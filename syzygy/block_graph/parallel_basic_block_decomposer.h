@@ -0,0 +1,152 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a decomposer that breaks batches of code blocks into basic-block
+// subgraphs on a pool of worker threads, and an iteration primitive that
+// uses it to decompose the blocks of a block graph ahead of a transform.
+//
+// Decomposition only reads the block graph, so it can safely run in parallel
+// as long as nothing mutates the graph meanwhile. Transforming the subgraphs
+// and merging them back into the block graph still happens serially, on the
+// iterating thread, and in the usual iteration order.
+
+#ifndef SYZYGY_BLOCK_GRAPH_PARALLEL_BASIC_BLOCK_DECOMPOSER_H_
+#define SYZYGY_BLOCK_GRAPH_PARALLEL_BASIC_BLOCK_DECOMPOSER_H_
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "syzygy/block_graph/basic_block_subgraph.h"
+#include "syzygy/block_graph/block_graph.h"
+#include "syzygy/block_graph/iterate.h"
+#include "syzygy/block_graph/transform_policy.h"
+
+namespace block_graph {
+
+class ParallelBasicBlockDecomposer {
+ public:
+  typedef std::vector<BlockGraph::Block*> BlockVector;
+
+  // The outcome of the decomposition of a block.
+  struct Decomposition {
+    Decomposition() : contains_unsupported_instructions(false) {}
+
+    // The subgraph of the block, or NULL if the decomposition failed.
+    std::unique_ptr<BasicBlockSubGraph> subgraph;
+    // True if the decomposition failed on unsupported instructions.
+    bool contains_unsupported_instructions;
+  };
+
+  // While an instance of this is alive, ApplyBasicBlockSubGraphTransform(s)
+  // take the decompositions of a given decomposer rather than decomposing the
+  // blocks themselves. This is meant to be used on the thread iterating the
+  // block graph, and nests.
+  class ScopedCurrent {
+   public:
+    explicit ScopedCurrent(ParallelBasicBlockDecomposer* decomposer);
+    ~ScopedCurrent();
+
+   private:
+    ParallelBasicBlockDecomposer* previous_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedCurrent);
+  };
+
+  // @param num_threads The number of worker threads to decompose with.
+  explicit ParallelBasicBlockDecomposer(size_t num_threads);
+  ~ParallelBasicBlockDecomposer();
+
+  // Decomposes a batch of code blocks, discarding the decompositions of the
+  // previous batch that were never taken. The block graph must not be
+  // modified while this runs.
+  // @param blocks The code blocks to decompose.
+  void Decompose(const BlockVector& blocks);
+
+  // Takes the decomposition of a block out of the current batch. A
+  // decomposition is only handed out if the references, the referrers and
+  // the size of the block are still those it was decomposed with.
+  // @param block The block whose decomposition is requested.
+  // @param decomposition Receives the decomposition of @p block.
+  // @returns true if @p block was part of the current batch and is unchanged
+  //     since, false otherwise.
+  bool TakeDecomposition(const BlockGraph::Block* block,
+                         Decomposition* decomposition);
+
+  // Decomposes a single block on the calling thread.
+  // @param block The block to decompose.
+  // @param decomposition Receives the decomposition of @p block.
+  static void DecomposeBlock(const BlockGraph::Block* block,
+                             Decomposition* decomposition);
+
+  // @returns the decomposer that ApplyBasicBlockSubGraphTransform(s) should
+  //     take decompositions from, or NULL if there is none.
+  static ParallelBasicBlockDecomposer* current();
+
+  // @returns the number of worker threads.
+  size_t num_threads() const { return num_threads_; }
+
+ protected:
+  // A decomposition along with the state of the block it was made from.
+  struct Snapshot {
+    Decomposition decomposition;
+    BlockGraph::Block::ReferenceMap references;
+    BlockGraph::Block::ReferrerSet referrers;
+    BlockGraph::Size size;
+  };
+
+  // The snapshots are keyed by block ID, as these are never reused.
+  typedef std::map<BlockGraph::BlockId, Snapshot> SnapshotMap;
+
+  // The number of worker threads.
+  size_t num_threads_;
+
+  // The decompositions of the current batch that have not been taken yet.
+  SnapshotMap snapshots_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ParallelBasicBlockDecomposer);
+};
+
+// Iterates over the blocks of a block graph with the same guarantees as
+// IterateBlockGraph, and in the same order, while decomposing the code blocks
+// ahead of time on a pool of worker threads.
+//
+// The blocks are visited in batches of consecutive blocks, none of which
+// refers to another. The code blocks of a batch that @p policy deems safe to
+// decompose are decomposed together, before the callback is invoked on each
+// block of the batch. Because the merge of a subgraph only rewires the block
+// it replaces and its immediate neighbours, the decompositions of a batch stay
+// valid until they are consumed.
+//
+// The callback is held to a stricter contract than with IterateBlockGraph: it
+// may only modify the current block and the blocks it is connected to by a
+// reference, in addition to creating new blocks. A decomposition whose block
+// had its references, referrers or size changed in the meantime is dropped,
+// and the block is then decomposed serially as usual.
+//
+// @param callback The callback to invoke for each pre-existing block.
+// @param policy The policy deciding which blocks to decompose.
+// @param num_threads The number of worker threads to decompose with.
+// @param block_graph The block graph to be iterated.
+// @returns true on success, false if the callback failed for any block.
+bool IterateBlockGraphWithParallelDecomposition(
+    const IterationCallback& callback,
+    const TransformPolicyInterface* policy,
+    size_t num_threads,
+    BlockGraph* block_graph);
+
+}  // namespace block_graph
+
+#endif  // SYZYGY_BLOCK_GRAPH_PARALLEL_BASIC_BLOCK_DECOMPOSER_H_
@@ -0,0 +1,198 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/block_graph/parallel_basic_block_decomposer.h"
+
+#include <vector>
+
+#include "base/bind.h"
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_test_util.h"
+#include "syzygy/block_graph/transform.h"
+
+namespace block_graph {
+
+namespace {
+
+typedef ParallelBasicBlockDecomposer::BlockVector BlockVector;
+typedef ParallelBasicBlockDecomposer::Decomposition Decomposition;
+
+// A basic-block transform that leaves the subgraphs untouched.
+class NoOpBasicBlockSubGraphTransform
+    : public BasicBlockSubGraphTransformInterface {
+ public:
+  const char* name() const override {
+    return "NoOpBasicBlockSubGraphTransform";
+  }
+
+  bool TransformBasicBlockSubGraph(const TransformPolicyInterface* policy,
+                                   BlockGraph* block_graph,
+                                   BasicBlockSubGraph* subgraph) override {
+    return true;
+  }
+};
+
+// A policy that only lets the blocks built by Syzygy be decomposed, as the
+// other code blocks of the test block graph have no data.
+class BuiltBySyzygyPolicy : public testing::DummyTransformPolicy {
+ public:
+  bool BlockIsSafeToBasicBlockDecompose(
+      const BlockGraph::Block* block) const override {
+    return (block->attributes() & BlockGraph::BUILT_BY_SYZYGY) != 0;
+  }
+};
+
+class ParallelBasicBlockDecomposerTest : public testing::BasicBlockTest {
+ public:
+  ParallelBasicBlockDecomposerTest() : pre_decomposed_blocks_(0) {}
+
+  virtual void SetUp() override {
+    ASSERT_NO_FATAL_FAILURE(InitBlockGraph());
+  }
+
+  // An iteration callback recording the visited blocks, and whether their
+  // decomposition was readily available.
+  bool RecordBlock(BlockGraph* block_graph, BlockGraph::Block* block) {
+    visited_blocks_.push_back(block->id());
+
+    ParallelBasicBlockDecomposer* decomposer =
+        ParallelBasicBlockDecomposer::current();
+    EXPECT_TRUE(decomposer != NULL);
+    Decomposition decomposition;
+    if (decomposer->TakeDecomposition(block, &decomposition)) {
+      EXPECT_EQ(assembly_func_, block);
+      EXPECT_TRUE(decomposition.subgraph.get() != NULL);
+      ++pre_decomposed_blocks_;
+    }
+    return true;
+  }
+
+  // An iteration callback applying a no-op transform to the decomposable
+  // code blocks.
+  bool TransformBlock(BlockGraph* block_graph, BlockGraph::Block* block) {
+    visited_blocks_.push_back(block->id());
+    if (block->type() != BlockGraph::CODE_BLOCK ||
+        !built_by_syzygy_policy_.BlockIsSafeToBasicBlockDecompose(block)) {
+      return true;
+    }
+
+    NoOpBasicBlockSubGraphTransform transform;
+    return ApplyBasicBlockSubGraphTransform(
+        &transform, &built_by_syzygy_policy_, block_graph, block, NULL);
+  }
+
+  // @returns the IDs of the blocks in iteration order.
+  std::vector<BlockGraph::BlockId> GetBlockIds() const {
+    std::vector<BlockGraph::BlockId> ids;
+    for (const auto& entry : block_graph_.blocks())
+      ids.push_back(entry.first);
+    return ids;
+  }
+
+  BuiltBySyzygyPolicy built_by_syzygy_policy_;
+  std::vector<BlockGraph::BlockId> visited_blocks_;
+  size_t pre_decomposed_blocks_;
+};
+
+}  // namespace
+
+TEST_F(ParallelBasicBlockDecomposerTest, DecomposeAndTake) {
+  ParallelBasicBlockDecomposer decomposer(2);
+  EXPECT_EQ(2u, decomposer.num_threads());
+  decomposer.Decompose(BlockVector(1, assembly_func_));
+
+  Decomposition decomposition;
+  ASSERT_TRUE(decomposer.TakeDecomposition(assembly_func_, &decomposition));
+  ASSERT_TRUE(decomposition.subgraph.get() != NULL);
+  EXPECT_FALSE(decomposition.contains_unsupported_instructions);
+  EXPECT_EQ(assembly_func_, decomposition.subgraph->original_block());
+  EXPECT_EQ(kNumBasicBlocks, decomposition.subgraph->basic_blocks().size());
+
+  // A decomposition can only be taken once.
+  Decomposition again;
+  EXPECT_FALSE(decomposer.TakeDecomposition(assembly_func_, &again));
+  EXPECT_TRUE(again.subgraph.get() == NULL);
+
+  // Blocks outside of the batch have no decomposition.
+  EXPECT_FALSE(decomposer.TakeDecomposition(func1_, &again));
+
+  // A new batch drops the decompositions that weren't taken.
+  decomposer.Decompose(BlockVector(1, assembly_func_));
+  decomposer.Decompose(BlockVector());
+  EXPECT_FALSE(decomposer.TakeDecomposition(assembly_func_, &again));
+}
+
+TEST_F(ParallelBasicBlockDecomposerTest, StaleDecompositionIsDropped) {
+  ParallelBasicBlockDecomposer decomposer(2);
+  decomposer.Decompose(BlockVector(1, assembly_func_));
+
+  // Add a referrer to the block after its decomposition.
+  BlockGraph::Block* referrer =
+      block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 4, "referrer");
+  ASSERT_TRUE(referrer != NULL);
+  ASSERT_TRUE(referrer->SetReference(0, BlockGraph::Reference(
+      BlockGraph::ABSOLUTE_REF, 4, assembly_func_, 0, 0)));
+
+  Decomposition decomposition;
+  EXPECT_FALSE(decomposer.TakeDecomposition(assembly_func_, &decomposition));
+  EXPECT_TRUE(decomposition.subgraph.get() == NULL);
+}
+
+TEST_F(ParallelBasicBlockDecomposerTest, ScopedCurrent) {
+  EXPECT_TRUE(ParallelBasicBlockDecomposer::current() == NULL);
+  ParallelBasicBlockDecomposer outer(1);
+  {
+    ParallelBasicBlockDecomposer::ScopedCurrent scoped_outer(&outer);
+    EXPECT_EQ(&outer, ParallelBasicBlockDecomposer::current());
+
+    ParallelBasicBlockDecomposer inner(1);
+    {
+      ParallelBasicBlockDecomposer::ScopedCurrent scoped_inner(&inner);
+      EXPECT_EQ(&inner, ParallelBasicBlockDecomposer::current());
+    }
+    EXPECT_EQ(&outer, ParallelBasicBlockDecomposer::current());
+  }
+  EXPECT_TRUE(ParallelBasicBlockDecomposer::current() == NULL);
+}
+
+TEST_F(ParallelBasicBlockDecomposerTest, IterationVisitsBlocksInOrder) {
+  std::vector<BlockGraph::BlockId> expected_blocks = GetBlockIds();
+
+  EXPECT_TRUE(IterateBlockGraphWithParallelDecomposition(
+      base::Bind(&ParallelBasicBlockDecomposerTest::RecordBlock,
+                 base::Unretained(this)),
+      &built_by_syzygy_policy_, 4, &block_graph_));
+  EXPECT_EQ(expected_blocks, visited_blocks_);
+
+  // The decomposable block is decomposed ahead of time.
+  EXPECT_EQ(1u, pre_decomposed_blocks_);
+  EXPECT_TRUE(ParallelBasicBlockDecomposer::current() == NULL);
+}
+
+TEST_F(ParallelBasicBlockDecomposerTest, IterationWithTransforms) {
+  std::vector<BlockGraph::BlockId> expected_blocks = GetBlockIds();
+  size_t block_count = block_graph_.blocks().size();
+
+  EXPECT_TRUE(IterateBlockGraphWithParallelDecomposition(
+      base::Bind(&ParallelBasicBlockDecomposerTest::TransformBlock,
+                 base::Unretained(this)),
+      &built_by_syzygy_policy_, 4, &block_graph_));
+  EXPECT_EQ(expected_blocks, visited_blocks_);
+
+  // The decomposable block got replaced by its transformed self.
+  EXPECT_EQ(block_count, block_graph_.blocks().size());
+  EXPECT_TRUE(block_graph_.GetBlockById(expected_blocks.back()) == NULL);
+}
+
+}  // namespace block_graph
@@ -14,12 +14,37 @@
 
 #include "syzygy/block_graph/transform.h"
 
-#include "syzygy/block_graph/basic_block_decomposer.h"
 #include "syzygy/block_graph/block_builder.h"
+#include "syzygy/block_graph/block_graph_journal.h"
 #include "syzygy/block_graph/block_util.h"
+#include "syzygy/block_graph/parallel_basic_block_decomposer.h"
 
 namespace block_graph {
 
+namespace {
+
+// Decomposes a block to basic blocks, or takes its decomposition from the
+// parallel decomposer in effect, if there's one.
+// @param block The block to decompose.
+// @param decomposition Receives the decomposition of @p block.
+void GetDecomposition(
+    BlockGraph::Block* block,
+    ParallelBasicBlockDecomposer::Decomposition* decomposition) {
+  DCHECK(block != NULL);
+  DCHECK(decomposition != NULL);
+
+  ParallelBasicBlockDecomposer* decomposer =
+      ParallelBasicBlockDecomposer::current();
+  if (decomposer != NULL &&
+      decomposer->TakeDecomposition(block, decomposition)) {
+    return;
+  }
+
+  ParallelBasicBlockDecomposer::DecomposeBlock(block, decomposition);
+}
+
+}  // namespace
+
 bool ApplyImageLayoutTransform(
     ImageLayoutTransformInterface* transform,
     const TransformPolicyInterface* policy,
@@ -44,6 +69,8 @@ bool ApplyImageLayoutTransform(
     block_size.push_back(block_it->first.size());
   }
 
+  core::PhaseProfiler::ScopedPhase phase(core::PhaseProfiler::current(),
+                                        transform->name());
   if (!transform->TransformImageLayout(policy, image_layout,
       ordered_block_graph)) {
     LOG(ERROR) << "Layout transform \"" << transform->name() << "\" failed.";
@@ -105,10 +132,17 @@ bool ApplyBlockGraphTransform(BlockGraphTransformInterface* transform,
   // that it still exists after the transform.
   BlockGraph::BlockId header_block_id = header_block->id();
 
+  // Record the changes made by this transform separately.
+  if (block_graph->journal() != NULL)
+    block_graph->journal()->BeginChangeSet(transform->name());
+
+  core::PhaseProfiler::ScopedPhase phase(core::PhaseProfiler::current(),
+                                        transform->name());
   if (!transform->TransformBlockGraph(policy, block_graph, header_block)) {
     LOG(ERROR) << "Transform \"" << transform->name() << "\" failed.";
     return false;
   }
+  SetPhaseCounts(*block_graph, &phase);
 
   // Ensure that the header block still exists. If it was changed, it needs
   // to have been changed in place.
@@ -159,12 +193,13 @@ bool ApplyBasicBlockSubGraphTransform(
   DCHECK(policy->BlockIsSafeToBasicBlockDecompose(block));
 
   // Decompose block to basic blocks.
-  BasicBlockSubGraph subgraph;
-  BasicBlockDecomposer bb_decomposer(block, &subgraph);
-  if (!bb_decomposer.Decompose()) {
+  ParallelBasicBlockDecomposer::Decomposition decomposition;
+  GetDecomposition(block, &decomposition);
+  BasicBlockSubGraph* subgraph = decomposition.subgraph.get();
+  if (subgraph == NULL) {
     // If the failure is due to unsupported instructions then simply mark the
     // block as undecomposable so it won't be processed again.
-    if (bb_decomposer.contains_unsupported_instructions()) {
+    if (decomposition.contains_unsupported_instructions) {
       VLOG(1) << "Block contains unsupported instruction(s): "
               << BlockInfo(block);
       block->set_attribute(BlockGraph::UNSUPPORTED_INSTRUCTIONS);
@@ -175,12 +210,12 @@ bool ApplyBasicBlockSubGraphTransform(
   }
 
   // Call the transform.
-  if (!transform->TransformBasicBlockSubGraph(policy, block_graph, &subgraph))
+  if (!transform->TransformBasicBlockSubGraph(policy, block_graph, subgraph))
     return false;
 
   // Update the block-graph post transform.
   BlockBuilder builder(block_graph);
-  if (!builder.Merge(&subgraph))
+  if (!builder.Merge(subgraph))
     return false;
 
   if (new_blocks != NULL) {
@@ -204,9 +239,10 @@ bool ApplyBasicBlockSubGraphTransforms(
   DCHECK(policy->BlockIsSafeToBasicBlockDecompose(block));
 
   // Decompose block to basic blocks.
-  BasicBlockSubGraph subgraph;
-  BasicBlockDecomposer bb_decomposer(block, &subgraph);
-  if (!bb_decomposer.Decompose())
+  ParallelBasicBlockDecomposer::Decomposition decomposition;
+  GetDecomposition(block, &decomposition);
+  BasicBlockSubGraph* subgraph = decomposition.subgraph.get();
+  if (subgraph == NULL)
     return false;
 
   // Call the transforms.
@@ -215,13 +251,13 @@ bool ApplyBasicBlockSubGraphTransforms(
   for (; it != transforms.end(); ++it) {
     BasicBlockSubGraphTransformInterface* transform = *it;
     DCHECK(transform != NULL);
-    if (!transform->TransformBasicBlockSubGraph(policy, block_graph, &subgraph))
+    if (!transform->TransformBasicBlockSubGraph(policy, block_graph, subgraph))
       return false;
   }
 
   // Update the block-graph post transform.
   BlockBuilder builder(block_graph);
-  if (!builder.Merge(&subgraph))
+  if (!builder.Merge(subgraph))
     return false;
 
   if (new_blocks != NULL) {
@@ -18,6 +18,7 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "syzygy/block_graph/block_graph_journal.h"
 #include "syzygy/block_graph/unittest_util.h"
 
 namespace block_graph {
@@ -214,6 +215,28 @@ TEST_F(ApplyBlockGraphTransformTest, DeletingHeaderFails) {
                                         header_block_));
 }
 
+TEST_F(ApplyBlockGraphTransformTest, JournalRecordsChangeSetPerTransform) {
+  BlockGraphJournal journal;
+  ScopedBlockGraphJournal scoped_journal(&block_graph_, &journal);
+
+  MockBlockGraphTransform transform;
+  EXPECT_CALL(transform, TransformBlockGraph(_, _, _)).Times(2).
+      WillRepeatedly(Return(true));
+  EXPECT_TRUE(ApplyBlockGraphTransform(&transform,
+                                       &policy_,
+                                       &block_graph_,
+                                       header_block_));
+  EXPECT_TRUE(ApplyBlockGraphTransform(&transform,
+                                       &policy_,
+                                       &block_graph_,
+                                       header_block_));
+
+  ASSERT_EQ(2u, journal.change_sets().size());
+  EXPECT_EQ(transform.name(), journal.change_sets()[0].name);
+  EXPECT_TRUE(journal.change_sets()[0].empty());
+  EXPECT_EQ(transform.name(), journal.change_sets()[1].name);
+}
+
 TEST_F(ApplyBlockGraphTransformTest, VectorTransformSucceeds) {
   MockBlockGraphTransform tx1, tx2, tx3;
   std::vector<BlockGraphTransformInterface*> txs;
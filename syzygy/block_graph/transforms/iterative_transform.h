@@ -20,6 +20,7 @@
 
 #include "base/bind.h"
 #include "syzygy/block_graph/iterate.h"
+#include "syzygy/block_graph/parallel_basic_block_decomposer.h"
 #include "syzygy/block_graph/transforms/named_transform.h"
 
 namespace block_graph {
@@ -38,6 +39,8 @@ template<class DerivedType>
 class IterativeTransformImpl
     : public NamedBlockGraphTransformImpl<DerivedType> {
  public:
+  IterativeTransformImpl() : num_decomposition_threads_(0) {}
+
   // This is the main body of the transform. This takes care of calling Pre,
   // iterating through the blocks and calling OnBlock for each one, and finally
   // calling Post. If any step fails the entire transform fails.
@@ -50,6 +53,21 @@ class IterativeTransformImpl
                                    BlockGraph* block_graph,
                                    BlockGraph::Block* header_block) override;
 
+  // @name Accessors.
+  // @{
+  // The number of worker threads decomposing the code blocks to basic blocks
+  // ahead of OnBlock. This only pays off for transforms applying basic-block
+  // transforms to most blocks, and requires OnBlock to only modify the block
+  // it is given and its immediate neighbours. Decomposition is done on the
+  // iterating thread if this is 0 or 1, which is the default.
+  size_t num_decomposition_threads() const {
+    return num_decomposition_threads_;
+  }
+  void set_num_decomposition_threads(size_t num_decomposition_threads) {
+    num_decomposition_threads_ = num_decomposition_threads;
+  }
+  // @}
+
  protected:
   // This function is called prior to the iterative portion of the transform.
   // If it fails, the rest of the transform will not run. A default
@@ -92,6 +110,9 @@ class IterativeTransformImpl
                                BlockGraph::Block* header_block) {
     return true;
   }
+
+  // The number of worker threads for decomposition.
+  size_t num_decomposition_threads_;
 };
 
 template <class DerivedType>
@@ -111,11 +132,16 @@ bool IterativeTransformImpl<DerivedType>::TransformBlockGraph(
     return false;
   }
 
-  bool result = IterateBlockGraph(
-      base::Bind(&DerivedType::OnBlock,
-                 base::Unretained(self),
-                 base::Unretained(policy)),
-      block_graph);
+  IterationCallback callback = base::Bind(&DerivedType::OnBlock,
+                                          base::Unretained(self),
+                                          base::Unretained(policy));
+  bool result = false;
+  if (num_decomposition_threads_ > 1) {
+    result = IterateBlockGraphWithParallelDecomposition(
+        callback, policy, num_decomposition_threads_, block_graph);
+  } else {
+    result = IterateBlockGraph(callback, block_graph);
+  }
   if (!result) {
     LOG(ERROR) << "Iteration failed for \"" << name() << "\" transform.";
     return false;
@@ -134,6 +134,22 @@ TEST_F(IterativeTransformTest, Normal) {
   EXPECT_EQ(2u, block_graph_.blocks().size());
 }
 
+TEST_F(IterativeTransformTest, ParallelDecomposition) {
+  StrictMock<MockIterativeTransform> transform;
+  transform.set_num_decomposition_threads(4);
+  EXPECT_EQ(4u, transform.num_decomposition_threads());
+
+  EXPECT_CALL(transform, PreBlockGraphIteration(_, _, _)).Times(1).
+      WillOnce(Return(true));
+  EXPECT_CALL(transform, OnBlock(_, _, _)).Times(2).
+      WillRepeatedly(Return(true));
+  EXPECT_CALL(transform, PostBlockGraphIteration(_, _, _)).Times(1).
+      WillOnce(Return(true));
+  EXPECT_TRUE(transform.TransformBlockGraph(
+      &policy_, &block_graph_, header_block_));
+  EXPECT_EQ(2u, block_graph_.blocks().size());
+}
+
 TEST_F(IterativeTransformTest, Add) {
   StrictMock<MockIterativeTransform> transform;
   EXPECT_CALL(transform, PreBlockGraphIteration(_, _, _)).Times(1).
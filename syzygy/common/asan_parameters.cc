@@ -162,6 +162,8 @@ const bool kDefaultLogAsText = true;
 // Default values of ZebraBlockHeap parameters.
 const uint32_t kDefaultZebraBlockHeapSize = 16 * 1024 * 1024;
 const float kDefaultZebraBlockHeapQuarantineRatio = 0.25f;
+const uint32_t kDefaultZebraBlockHeapRegionCount = 4;
+const uint32_t kMaxZebraBlockHeapRegionCount = 15;
 
 // Default values of the BlockHeapManager parameters.
 const bool kDefaultEnableRateTargetedHeaps = true;
@@ -169,6 +171,21 @@ const bool kDefaultEnableZebraBlockHeap = false;
 const bool kDefaultEnableAllocationFilter = false;
 const float kDefaultQuarantineFloodFillRate = 0.5f;
 const bool kDefaultPreventDuplicateCorruptionCrashes = false;
+const bool kDefaultEnableThreadLocalBlockCache = false;
+const bool kDefaultEnablePerCpuQuarantine = false;
+const bool kDefaultEnableShadowDecommit = false;
+const bool kDefaultEnableCompactStackCache = false;
+const bool kDefaultEnableSampledAllocationGuards = false;
+const bool kDefaultEnableBufferedLogging = false;
+const bool kDefaultEnableSlabBlockHeap = false;
+const bool kDefaultEnableSizeClassQuarantine = false;
+const bool kDefaultEnableLargePageShadow = false;
+const float kDefaultFullStackCaptureRate = 1.0f;
+const uint32_t kDefaultFullStackCapturesPerSite = 16;
+const uint32_t kDefaultDeferredFreeThreadCount = 1;
+const uint32_t kMaxDeferredFreeThreadCount = 15;
+const uint32_t kDefaultHeapCheckerThreadCount = 0;
+const uint32_t kMaxHeapCheckerThreadCount = 15;
 
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap = true;
@@ -211,6 +228,8 @@ const char kParamNoLogAsText[] = "no_log_as_text";
 const char kParamZebraBlockHeapSize[] = "zebra_block_heap_size";
 const char kParamZebraBlockHeapQuarantineRatio[] =
     "zebra_block_heap_quarantine_ratio";
+const char kParamZebraBlockHeapRegionCount[] =
+    "zebra_block_heap_region_count";
 
 // String names of BlockHeapManager parameters.
 const char kParamDisableCtMalloc[] = "disable_ctmalloc";
@@ -219,6 +238,19 @@ const char kParamEnableAllocationFilter[] = "enable_allocation_filter";
 const char kParamQuarantineFloodFillRate[] = "quarantine_flood_fill_rate";
 const char kParamPreventDuplicateCorruptionCrashes[] =
     "prevent_duplicate_corruption_crashes";
+const char kParamThreadLocalBlockCache[] = "thread_local_block_cache";
+const char kParamPerCpuQuarantine[] = "per_cpu_quarantine";
+const char kParamShadowDecommit[] = "shadow_decommit";
+const char kParamCompactStackCache[] = "compact_stack_cache";
+const char kParamSampledAllocationGuards[] = "sampled_allocation_guards";
+const char kParamBufferedLogging[] = "buffered_logging";
+const char kParamSlabBlockHeap[] = "slab_block_heap";
+const char kParamSizeClassQuarantine[] = "size_class_quarantine";
+const char kParamLargePageShadow[] = "large_page_shadow";
+const char kParamFullStackCaptureRate[] = "full_stack_capture_rate";
+const char kParamFullStackCapturesPerSite[] = "full_stack_captures_per_site";
+const char kParamDeferredFreeThreadCount[] = "deferred_free_thread_count";
+const char kParamHeapCheckerThreadCount[] = "heap_checker_thread_count";
 
 // String names of LargeBlockHeap parameters.
 const char kParamDisableLargeBlockHeap[] = "disable_large_block_heap";
@@ -308,13 +340,34 @@ void SetDefaultAsanParameters(AsanParameters* asan_parameters) {
   asan_parameters->report_invalid_accesses = kDefaultReportInvalidAccesses;
   asan_parameters->defer_crash_reporter_initialization =
       kDefaultDeferCrashReporterInitialization;
+  asan_parameters->enable_thread_local_block_cache =
+      kDefaultEnableThreadLocalBlockCache;
+  asan_parameters->enable_per_cpu_quarantine = kDefaultEnablePerCpuQuarantine;
+  asan_parameters->enable_shadow_decommit = kDefaultEnableShadowDecommit;
+  asan_parameters->enable_compact_stack_cache = kDefaultEnableCompactStackCache;
+  asan_parameters->enable_sampled_allocation_guards =
+      kDefaultEnableSampledAllocationGuards;
+  asan_parameters->deferred_free_thread_count =
+      kDefaultDeferredFreeThreadCount;
+  asan_parameters->zebra_block_heap_region_count =
+      kDefaultZebraBlockHeapRegionCount;
+  asan_parameters->enable_buffered_logging = kDefaultEnableBufferedLogging;
+  asan_parameters->heap_checker_thread_count = kDefaultHeapCheckerThreadCount;
+  asan_parameters->full_stack_capture_rate = kDefaultFullStackCaptureRate;
+  asan_parameters->full_stack_captures_per_site =
+      kDefaultFullStackCapturesPerSite;
+  asan_parameters->enable_slab_block_heap = kDefaultEnableSlabBlockHeap;
+  asan_parameters->enable_size_class_quarantine =
+      kDefaultEnableSizeClassQuarantine;
+  asan_parameters->enable_large_page_shadow = kDefaultEnableLargePageShadow;
 }
 
 bool InflateAsanParameters(const AsanParameters* pod_params,
                            InflatedAsanParameters* inflated_params) {
   // This must be kept up to date with AsanParameters as it evolves.
   static const size_t kSizeOfAsanParametersByVersion[] = {
-      40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60, 60, 60, 60};
+      40, 44, 48, 52, 52, 52, 56, 56, 56, 56, 60, 60, 60, 60, 60, 60, 60, 60,
+      60, 60, 60, 60, 60, 60, 60, 68, 68, 72, 72};
   static_assert(
       arraysize(kSizeOfAsanParametersByVersion) == kAsanParametersVersion + 1,
       "Size of parameters version out of date.");
@@ -480,6 +533,23 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
     return false;
   }
 
+  // Parse the maximum number of zebra block heap regions. This is stored in a
+  // bitfield, so it is range checked.
+  uint32_t zebra_block_heap_region_count =
+      asan_parameters->zebra_block_heap_region_count;
+  if (UpdateUint32FromCommandLine::Do(cmd_line,
+          kParamZebraBlockHeapRegionCount,
+          &zebra_block_heap_region_count) == kFlagError) {
+    return false;
+  }
+  if (zebra_block_heap_region_count > kMaxZebraBlockHeapRegionCount) {
+    LOG(ERROR) << "Invalid value for " << kParamZebraBlockHeapRegionCount
+               << ": " << zebra_block_heap_region_count << ".";
+    return false;
+  }
+  asan_parameters->zebra_block_heap_region_count =
+      zebra_block_heap_region_count;
+
   // Parse the large block heap allocation threshold.
   if (UpdateUint32FromCommandLine::Do(cmd_line,
           kParamLargeAllocationThreshold,
@@ -494,6 +564,50 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
     return false;
   }
 
+  // Parse the full stack capture policy.
+  if (UpdateFloatFromCommandLine::Do(cmd_line,
+          kParamFullStackCaptureRate,
+          &asan_parameters->full_stack_capture_rate) == kFlagError) {
+    return false;
+  }
+  if (UpdateUint32FromCommandLine::Do(cmd_line,
+          kParamFullStackCapturesPerSite,
+          &asan_parameters->full_stack_captures_per_site) == kFlagError) {
+    return false;
+  }
+
+  // Parse the number of deferred free threads. This is stored in a bitfield,
+  // so it is range checked.
+  uint32_t deferred_free_thread_count =
+      asan_parameters->deferred_free_thread_count;
+  if (UpdateUint32FromCommandLine::Do(cmd_line,
+          kParamDeferredFreeThreadCount,
+          &deferred_free_thread_count) == kFlagError) {
+    return false;
+  }
+  if (deferred_free_thread_count > kMaxDeferredFreeThreadCount) {
+    LOG(ERROR) << "Invalid value for " << kParamDeferredFreeThreadCount
+               << ": " << deferred_free_thread_count << ".";
+    return false;
+  }
+  asan_parameters->deferred_free_thread_count = deferred_free_thread_count;
+
+  // Parse the number of heap checker threads, which is also stored in a
+  // bitfield.
+  uint32_t heap_checker_thread_count =
+      asan_parameters->heap_checker_thread_count;
+  if (UpdateUint32FromCommandLine::Do(cmd_line,
+          kParamHeapCheckerThreadCount,
+          &heap_checker_thread_count) == kFlagError) {
+    return false;
+  }
+  if (heap_checker_thread_count > kMaxHeapCheckerThreadCount) {
+    LOG(ERROR) << "Invalid value for " << kParamHeapCheckerThreadCount
+               << ": " << heap_checker_thread_count << ".";
+    return false;
+  }
+  asan_parameters->heap_checker_thread_count = heap_checker_thread_count;
+
   // Parse the other (boolean) flags.
   // TODO(chrisha): Transition these all to new style flags.
   if (cmd_line.HasSwitch(kParamMiniDumpOnFailure))
@@ -527,6 +641,24 @@ bool ParseAsanParameters(const base::StringPiece16& param_string,
   bool value = false;
   if (ParseBooleanFlag(kParamFeatureRandomization, cmd_line, &value))
     asan_parameters->feature_randomization = value;
+  if (ParseBooleanFlag(kParamThreadLocalBlockCache, cmd_line, &value))
+    asan_parameters->enable_thread_local_block_cache = value;
+  if (ParseBooleanFlag(kParamPerCpuQuarantine, cmd_line, &value))
+    asan_parameters->enable_per_cpu_quarantine = value;
+  if (ParseBooleanFlag(kParamShadowDecommit, cmd_line, &value))
+    asan_parameters->enable_shadow_decommit = value;
+  if (ParseBooleanFlag(kParamCompactStackCache, cmd_line, &value))
+    asan_parameters->enable_compact_stack_cache = value;
+  if (ParseBooleanFlag(kParamSampledAllocationGuards, cmd_line, &value))
+    asan_parameters->enable_sampled_allocation_guards = value;
+  if (ParseBooleanFlag(kParamBufferedLogging, cmd_line, &value))
+    asan_parameters->enable_buffered_logging = value;
+  if (ParseBooleanFlag(kParamSlabBlockHeap, cmd_line, &value))
+    asan_parameters->enable_slab_block_heap = value;
+  if (ParseBooleanFlag(kParamSizeClassQuarantine, cmd_line, &value))
+    asan_parameters->enable_size_class_quarantine = value;
+  if (ParseBooleanFlag(kParamLargePageShadow, cmd_line, &value))
+    asan_parameters->enable_large_page_shadow = value;
 
   return true;
 }
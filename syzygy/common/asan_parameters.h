@@ -36,7 +36,8 @@ namespace common {
 // the StackCaptureCache.
 typedef uint32_t AsanStackId;
 
-static const size_t kAsanParametersReserved1Bits = 19;
+static const size_t kAsanParametersReserved1Bits = 0;
+static const size_t kAsanParametersReserved2Bits = 30;
 
 // This data structure is injected into an instrumented image in a read-only
 // section. It is initialized by the instrumenter, and will be looked up at
@@ -119,10 +120,41 @@ struct AsanParameters {
       // Runtime: Defer the crash reporter initialization, the client has to
       // manually call the crash reporter initialization function.
       unsigned defer_crash_reporter_initialization : 1;
-
-      // Add new flags here!
-
-      unsigned reserved1 : kAsanParametersReserved1Bits;
+      // BlockHeapManager: Indicates if allocations served by the simple block
+      // heaps should go through per-thread caches of blocks.
+      unsigned enable_thread_local_block_cache : 1;
+      // BlockHeapManager: Indicates if the shared quarantine should be made of
+      // lock-free per-processor lists rather than a sharded list.
+      unsigned enable_per_cpu_quarantine : 1;
+      // Runtime: Indicates if the shadow memory describing large regions of
+      // memory returned to the OS should be decommitted. Only used on x64.
+      unsigned enable_shadow_decommit : 1;
+      // Runtime: Indicates if the frames of the stack captures saved in the
+      // stack cache should be stored delta-encoded, which uses less memory.
+      unsigned enable_compact_stack_cache : 1;
+      // Runtime: Indicates if the allocations selected by allocation_guard_rate
+      // should be sampled with a cheap per-thread countdown, and placed in the
+      // page protected slots of the zebra and large block heaps.
+      unsigned enable_sampled_allocation_guards : 1;
+      // BlockHeapManager: The number of threads that trim the shared
+      // quarantine when deferred freeing is enabled. Zero is treated as one.
+      unsigned deferred_free_thread_count : 4;
+      // ZebraBlockHeap: The maximum number of regions of zebra_block_heap_size
+      // bytes that the heap may reserve as it fills up. Zero is treated as one.
+      unsigned zebra_block_heap_region_count : 4;
+      // Runtime: If true then log messages are buffered and sent to the logger
+      // in batches by a background thread.
+      unsigned enable_buffered_logging : 1;
+      // HeapChecker: The number of threads that walk the heap when checking
+      // it for corruption. Zero and one both mean a walk on the crashing
+      // thread alone.
+      unsigned heap_checker_thread_count : 4;
+      // BlockHeapManager: Indicates if small allocations should be served by
+      // the size-class segregated SlabBlockHeap.
+      unsigned enable_slab_block_heap : 1;
+
+      // This bitfield is full. Add new flags to a new bitfield at the end of
+      // the structure.
     };
   };
 
@@ -148,27 +180,57 @@ struct AsanParameters {
   // 0.0 corresponds to this being disabled entirely.
   float quarantine_flood_fill_rate;
 
+  // BlockHeapManager: The rate at which allocations and frees have their full
+  // stack captured. The others only save a few innermost frames, a fingerprint
+  // that still identifies the allocating or freeing function. A value in the
+  // range 0.0 to 1.0, inclusive.
+  float full_stack_capture_rate;
+
+  // BlockHeapManager: The number of allocations and frees at each call site
+  // that have their full stack captured, whatever full_stack_capture_rate is.
+  // Call sites are told apart by their fingerprint.
+  uint32_t full_stack_captures_per_site;
+
+  // Second bitfield of boolean values.
+  union {
+    uint32_t bitfield2;
+    struct {
+      // BlockHeapManager: Indicates if the quarantine should keep a separate
+      // budget per size class, evicting the large blocks first.
+      unsigned enable_size_class_quarantine : 1;
+      // AsanRuntime: Indicates if the shadow memory should be backed by large
+      // pages, when the privilege to use them is held. Only supported on
+      // 32-bit, where the shadow is committed all at once.
+      unsigned enable_large_page_shadow : 1;
+
+      // Add new flags here!
+
+      unsigned reserved2 : kAsanParametersReserved2Bits;
+    };
+  };
+
   // Add new parameters here!
 
   // When laid out in memory the ignored_stack_ids are present here as a NULL
   // terminated vector.
 };
 #ifndef _WIN64
-COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 60);
+COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 72);
 #else
-COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 64);
+COMPILE_ASSERT_IS_POD_OF_SIZE(AsanParameters, 76);
 #endif
 
 // The current version of the Asan parameters structure. This must be updated
 // if any changes are made to the above structure! This is defined in the header
 // file to allow compile time assertions against this version number.
-const uint32_t kAsanParametersVersion = 15;
+const uint32_t kAsanParametersVersion = 28;
 
 // If the number of free bits in the parameters struct changes, then the
 // version has to change as well. This is simply here to make sure that
 // everything changes in lockstep.
-static_assert(kAsanParametersReserved1Bits == 19 &&
-                  kAsanParametersVersion == 15,
+static_assert(kAsanParametersReserved1Bits == 0 &&
+                  kAsanParametersReserved2Bits == 30 &&
+                  kAsanParametersVersion == 28,
               "Version must change if reserved bits changes.");
 
 // The name of the section that will be injected into an instrumented image,
@@ -247,11 +309,31 @@ extern const bool kDefaultLogAsText;
 // Default values of ZebraBlockHeap parameters.
 extern const uint32_t kDefaultZebraBlockHeapSize;
 extern const float kDefaultZebraBlockHeapQuarantineRatio;
+extern const uint32_t kDefaultZebraBlockHeapRegionCount;
+// The maximum number of regions of the ZebraBlockHeap.
+extern const uint32_t kMaxZebraBlockHeapRegionCount;
 // Default values of the BlockHeapManager parameters.
 extern const bool kDefaultEnableZebraBlockHeap;
 extern const bool kDefaultEnableAllocationFilter;
 extern const float kDefaultQuarantineFloodFillRate;
 extern const bool kDefaultPreventDuplicateCorruptionCrashes;
+extern const bool kDefaultEnableThreadLocalBlockCache;
+extern const bool kDefaultEnablePerCpuQuarantine;
+extern const bool kDefaultEnableShadowDecommit;
+extern const bool kDefaultEnableCompactStackCache;
+extern const bool kDefaultEnableSampledAllocationGuards;
+extern const bool kDefaultEnableBufferedLogging;
+extern const bool kDefaultEnableSlabBlockHeap;
+extern const bool kDefaultEnableSizeClassQuarantine;
+extern const bool kDefaultEnableLargePageShadow;
+extern const float kDefaultFullStackCaptureRate;
+extern const uint32_t kDefaultFullStackCapturesPerSite;
+extern const uint32_t kDefaultDeferredFreeThreadCount;
+// The maximum number of deferred free threads.
+extern const uint32_t kMaxDeferredFreeThreadCount;
+extern const uint32_t kDefaultHeapCheckerThreadCount;
+// The maximum number of heap checker threads.
+extern const uint32_t kMaxHeapCheckerThreadCount;
 // Default values of LargeBlockHeap parameters.
 extern const bool kDefaultEnableLargeBlockHeap;
 extern const size_t kDefaultLargeAllocationThreshold;
@@ -286,12 +368,26 @@ extern const char kParamLogAsText[];
 // String names of ZebraBlockHeap parameters.
 extern const char kParamZebraBlockHeapSize[];
 extern const char kParamZebraBlockHeapQuarantineRatio[];
+extern const char kParamZebraBlockHeapRegionCount[];
 // String names of BlockHeapManager parameters.
 extern const char kParamDisableSizeTargetedHeaps[];
 extern const char kParamEnableZebraBlockHeap[];
 extern const char kParamEnableAllocationFilter[];
 extern const char kParamQuarantineFloodFillRate[];
 extern const char kParamPreventDuplicateCorruptionCrashes[];
+extern const char kParamThreadLocalBlockCache[];
+extern const char kParamPerCpuQuarantine[];
+extern const char kParamShadowDecommit[];
+extern const char kParamCompactStackCache[];
+extern const char kParamSampledAllocationGuards[];
+extern const char kParamBufferedLogging[];
+extern const char kParamSlabBlockHeap[];
+extern const char kParamSizeClassQuarantine[];
+extern const char kParamLargePageShadow[];
+extern const char kParamFullStackCaptureRate[];
+extern const char kParamFullStackCapturesPerSite[];
+extern const char kParamDeferredFreeThreadCount[];
+extern const char kParamHeapCheckerThreadCount[];
 // String names of LargeBlockHeap parameters.
 extern const char kParamDisableLargeBlockHeap[];
 extern const char kParamLargeAllocationThreshold[];
@@ -74,7 +74,6 @@ TEST(AsanParametersTest, SetDefaultAsanParameters) {
             static_cast<bool>(aparams.log_as_text));
   EXPECT_EQ(kDefaultDisableBreakpadReporting,
             static_cast<bool>(aparams.disable_breakpad_reporting));
-  EXPECT_EQ(0u, aparams.reserved1);
   EXPECT_EQ(kDefaultAllocationGuardRate, aparams.allocation_guard_rate);
   EXPECT_EQ(kDefaultZebraBlockHeapSize, aparams.zebra_block_heap_size);
   EXPECT_EQ(kDefaultZebraBlockHeapQuarantineRatio,
@@ -90,6 +89,9 @@ TEST(AsanParametersTest, SetDefaultAsanParameters) {
             aparams.large_allocation_threshold);
   EXPECT_EQ(kDefaultQuarantineFloodFillRate,
             aparams.quarantine_flood_fill_rate);
+  EXPECT_EQ(kDefaultFullStackCaptureRate, aparams.full_stack_capture_rate);
+  EXPECT_EQ(kDefaultFullStackCapturesPerSite,
+            aparams.full_stack_captures_per_site);
   EXPECT_EQ(kDefaultFeatureRandomization,
             static_cast<bool>(aparams.feature_randomization));
   EXPECT_EQ(kDefaultPreventDuplicateCorruptionCrashes,
@@ -98,6 +100,30 @@ TEST(AsanParametersTest, SetDefaultAsanParameters) {
             static_cast<bool>(aparams.report_invalid_accesses));
   EXPECT_EQ(kDefaultDeferCrashReporterInitialization,
             static_cast<bool>(aparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(kDefaultEnableThreadLocalBlockCache,
+            static_cast<bool>(aparams.enable_thread_local_block_cache));
+  EXPECT_EQ(kDefaultEnablePerCpuQuarantine,
+            static_cast<bool>(aparams.enable_per_cpu_quarantine));
+  EXPECT_EQ(kDefaultEnableShadowDecommit,
+            static_cast<bool>(aparams.enable_shadow_decommit));
+  EXPECT_EQ(kDefaultEnableCompactStackCache,
+            static_cast<bool>(aparams.enable_compact_stack_cache));
+  EXPECT_EQ(kDefaultEnableSampledAllocationGuards,
+            static_cast<bool>(aparams.enable_sampled_allocation_guards));
+  EXPECT_EQ(kDefaultEnableBufferedLogging,
+            static_cast<bool>(aparams.enable_buffered_logging));
+  EXPECT_EQ(kDefaultDeferredFreeThreadCount,
+            aparams.deferred_free_thread_count);
+  EXPECT_EQ(kDefaultZebraBlockHeapRegionCount,
+            aparams.zebra_block_heap_region_count);
+  EXPECT_EQ(kDefaultHeapCheckerThreadCount,
+            aparams.heap_checker_thread_count);
+  EXPECT_EQ(kDefaultEnableSlabBlockHeap,
+            static_cast<bool>(aparams.enable_slab_block_heap));
+  EXPECT_EQ(kDefaultEnableSizeClassQuarantine,
+            static_cast<bool>(aparams.enable_size_class_quarantine));
+  EXPECT_EQ(kDefaultEnableLargePageShadow,
+            static_cast<bool>(aparams.enable_large_page_shadow));
 }
 
 TEST(AsanParametersTest, InflateAsanParametersStackIdsPastEnd) {
@@ -231,7 +257,6 @@ TEST(AsanParametersTest, ParseAsanParametersMinimal) {
             static_cast<bool>(iparams.log_as_text));
   EXPECT_EQ(kDefaultCheckHeapOnFailure,
             static_cast<bool>(iparams.check_heap_on_failure));
-  EXPECT_EQ(0u, iparams.reserved1);
   EXPECT_TRUE(iparams.ignored_stack_ids_set.empty());
   EXPECT_EQ(kDefaultZebraBlockHeapSize, iparams.zebra_block_heap_size);
   EXPECT_EQ(kDefaultZebraBlockHeapQuarantineRatio,
@@ -247,6 +272,9 @@ TEST(AsanParametersTest, ParseAsanParametersMinimal) {
             iparams.large_allocation_threshold);
   EXPECT_EQ(kDefaultQuarantineFloodFillRate,
             iparams.quarantine_flood_fill_rate);
+  EXPECT_EQ(kDefaultFullStackCaptureRate, iparams.full_stack_capture_rate);
+  EXPECT_EQ(kDefaultFullStackCapturesPerSite,
+            iparams.full_stack_captures_per_site);
   EXPECT_EQ(kDefaultFeatureRandomization,
             static_cast<bool>(iparams.feature_randomization));
   EXPECT_EQ(kDefaultPreventDuplicateCorruptionCrashes,
@@ -255,6 +283,30 @@ TEST(AsanParametersTest, ParseAsanParametersMinimal) {
             static_cast<bool>(iparams.report_invalid_accesses));
   EXPECT_EQ(kDefaultDeferCrashReporterInitialization,
             static_cast<bool>(iparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(kDefaultEnableThreadLocalBlockCache,
+            static_cast<bool>(iparams.enable_thread_local_block_cache));
+  EXPECT_EQ(kDefaultEnablePerCpuQuarantine,
+            static_cast<bool>(iparams.enable_per_cpu_quarantine));
+  EXPECT_EQ(kDefaultEnableShadowDecommit,
+            static_cast<bool>(iparams.enable_shadow_decommit));
+  EXPECT_EQ(kDefaultEnableCompactStackCache,
+            static_cast<bool>(iparams.enable_compact_stack_cache));
+  EXPECT_EQ(kDefaultEnableSampledAllocationGuards,
+            static_cast<bool>(iparams.enable_sampled_allocation_guards));
+  EXPECT_EQ(kDefaultEnableBufferedLogging,
+            static_cast<bool>(iparams.enable_buffered_logging));
+  EXPECT_EQ(kDefaultDeferredFreeThreadCount,
+            iparams.deferred_free_thread_count);
+  EXPECT_EQ(kDefaultZebraBlockHeapRegionCount,
+            iparams.zebra_block_heap_region_count);
+  EXPECT_EQ(kDefaultHeapCheckerThreadCount,
+            iparams.heap_checker_thread_count);
+  EXPECT_EQ(kDefaultEnableSlabBlockHeap,
+            static_cast<bool>(iparams.enable_slab_block_heap));
+  EXPECT_EQ(kDefaultEnableSizeClassQuarantine,
+            static_cast<bool>(iparams.enable_size_class_quarantine));
+  EXPECT_EQ(kDefaultEnableLargePageShadow,
+            static_cast<bool>(iparams.enable_large_page_shadow));
 }
 
 TEST(AsanParametersTest, ParseAsanParametersMaximal) {
@@ -280,10 +332,24 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
       L"--enable_allocation_filter "
       L"--large_allocation_threshold=4096 "
       L"--quarantine_flood_fill_rate=0.25 "
+      L"--full_stack_capture_rate=0.125 "
+      L"--full_stack_captures_per_site=8 "
       L"--enable_feature_randomization "
       L"--prevent_duplicate_corruption_crashes "
       L"--report_invalid_accesses "
-      L"--defer_crash_reporter_initialization";
+      L"--defer_crash_reporter_initialization "
+      L"--enable_thread_local_block_cache "
+      L"--enable_per_cpu_quarantine "
+      L"--enable_shadow_decommit "
+      L"--enable_compact_stack_cache "
+      L"--enable_sampled_allocation_guards "
+      L"--deferred_free_thread_count=4 "
+      L"--zebra_block_heap_region_count=3 "
+      L"--enable_buffered_logging "
+      L"--heap_checker_thread_count=2 "
+      L"--enable_slab_block_heap "
+      L"--enable_size_class_quarantine "
+      L"--enable_large_page_shadow";
 
   InflatedAsanParameters iparams;
   SetDefaultAsanParameters(&iparams);
@@ -302,7 +368,6 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
   EXPECT_EQ(false, static_cast<bool>(iparams.check_heap_on_failure));
   EXPECT_EQ(false, static_cast<bool>(iparams.log_as_text));
   EXPECT_EQ(true, static_cast<bool>(iparams.disable_breakpad_reporting));
-  EXPECT_EQ(0u, iparams.reserved1);
   EXPECT_EQ(0.6f, iparams.allocation_guard_rate);
   EXPECT_THAT(iparams.ignored_stack_ids_set,
               testing::ElementsAre(0x1, 0xBAADF00D, 0xCAFEBABE, 0xDEADBEEF));
@@ -314,12 +379,77 @@ TEST(AsanParametersTest, ParseAsanParametersMaximal) {
   EXPECT_TRUE(static_cast<bool>(iparams.enable_allocation_filter));
   EXPECT_EQ(4096, iparams.large_allocation_threshold);
   EXPECT_EQ(0.25f, iparams.quarantine_flood_fill_rate);
+  EXPECT_EQ(0.125f, iparams.full_stack_capture_rate);
+  EXPECT_EQ(8, iparams.full_stack_captures_per_site);
   EXPECT_EQ(true, static_cast<bool>(iparams.feature_randomization));
   EXPECT_EQ(true, static_cast<bool>(
       iparams.prevent_duplicate_corruption_crashes));
   EXPECT_EQ(true, static_cast<bool>(iparams.report_invalid_accesses));
   EXPECT_EQ(true,
             static_cast<bool>(iparams.defer_crash_reporter_initialization));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_thread_local_block_cache));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_per_cpu_quarantine));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_shadow_decommit));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_compact_stack_cache));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_sampled_allocation_guards));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_buffered_logging));
+  EXPECT_EQ(4u, iparams.deferred_free_thread_count);
+  EXPECT_EQ(3u, iparams.zebra_block_heap_region_count);
+  EXPECT_EQ(2u, iparams.heap_checker_thread_count);
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_slab_block_heap));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_size_class_quarantine));
+  EXPECT_EQ(true,
+            static_cast<bool>(iparams.enable_large_page_shadow));
+}
+
+TEST(AsanParametersTest, ParseAsanParametersDeferredFreeThreadCount) {
+  InflatedAsanParameters iparams;
+  SetDefaultAsanParameters(&iparams);
+  EXPECT_TRUE(ParseAsanParameters(L"--deferred_free_thread_count=15",
+                                  &iparams));
+  EXPECT_EQ(15u, iparams.deferred_free_thread_count);
+  EXPECT_EQ(0u, iparams.enable_slab_block_heap);
+
+  // The value must fit in its bitfield.
+  EXPECT_FALSE(ParseAsanParameters(L"--deferred_free_thread_count=16",
+                                   &iparams));
+  EXPECT_EQ(15u, iparams.deferred_free_thread_count);
+}
+
+TEST(AsanParametersTest, ParseAsanParametersZebraBlockHeapRegionCount) {
+  InflatedAsanParameters iparams;
+  SetDefaultAsanParameters(&iparams);
+  EXPECT_TRUE(ParseAsanParameters(L"--zebra_block_heap_region_count=15",
+                                  &iparams));
+  EXPECT_EQ(15u, iparams.zebra_block_heap_region_count);
+  EXPECT_EQ(0u, iparams.enable_slab_block_heap);
+
+  // The value must fit in its bitfield.
+  EXPECT_FALSE(ParseAsanParameters(L"--zebra_block_heap_region_count=16",
+                                   &iparams));
+  EXPECT_EQ(15u, iparams.zebra_block_heap_region_count);
+}
+
+TEST(AsanParametersTest, ParseAsanParametersHeapCheckerThreadCount) {
+  InflatedAsanParameters iparams;
+  SetDefaultAsanParameters(&iparams);
+  EXPECT_TRUE(ParseAsanParameters(L"--heap_checker_thread_count=15",
+                                  &iparams));
+  EXPECT_EQ(15u, iparams.heap_checker_thread_count);
+  EXPECT_EQ(0u, iparams.enable_slab_block_heap);
+
+  // The value must fit in its bitfield.
+  EXPECT_FALSE(ParseAsanParameters(L"--heap_checker_thread_count=16",
+                                   &iparams));
+  EXPECT_EQ(15u, iparams.heap_checker_thread_count);
 }
 
 }  // namespace common
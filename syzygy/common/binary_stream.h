@@ -37,7 +37,8 @@ class BinaryStreamReader {
   // @param len the number of bytes to read.
   // @param out a buffer for the read bytes, must be at least @p len bytes in
   //     size. On failure the contents of @p out are undefined.
-  // @returns true iff @p len bytes were read, false otherwise.
+  // @returns true iff @p len bytes were read, false otherwise. On failure the
+  //     position of the stream is unchanged.
   virtual bool Read(size_t len, void* out) = 0;
 
   // Get the current position of the stream.
@@ -159,8 +160,18 @@ template <typename DataType>
 bool BinaryStreamParser::ReadMultiple(size_t elements,
                                       std::vector<DataType>* data) const {
   DCHECK(data != nullptr);
-  // Reserve for the new data to save on reallocs.
-  data->reserve(data->size() + elements);
+  if (elements == 0)
+    return true;
+
+  // Read all the elements at once.
+  size_t old_size = data->size();
+  data->resize(old_size + elements);
+  if (ReadBytes(elements * sizeof(DataType), &data->at(old_size)))
+    return true;
+
+  // The stream position is unchanged on failure, so read the elements one at
+  // a time to return the partial data.
+  data->resize(old_size);
   for (size_t read = 0; read < elements; ++read) {
     DataType tmp = {};
     if (!Read(&tmp))
@@ -119,6 +119,14 @@ VectorBufferWriter::VectorBufferWriter(std::vector<uint8_t>* vector)
     SetBuffer(&(*vector_)[0], vector_->size());
 }
 
+void VectorBufferWriter::Reserve(size_t bytes) {
+  vector_->reserve(pos() + bytes);
+
+  // The vector may have been reallocated.
+  if (!vector_->empty())
+    SetBuffer(&(*vector_)[0], vector_->size());
+}
+
 uint8_t* VectorBufferWriter::GrowBuffer(size_t new_length) {
   // NOTE: While this may appear to be O(N^2), it's actually not. vector is
   // smart enough to double the size of the allocation when a resize causes
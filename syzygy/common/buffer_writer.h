@@ -153,6 +153,12 @@ class VectorBufferWriter : public BufferWriter {
   //     will cause it to grow.
   explicit VectorBufferWriter(std::vector<uint8_t>* vector);
 
+  // Reserves room in the vector for @p bytes to be written from the current
+  // position, so that writing them doesn't reallocate it. This is worthwhile
+  // ahead of many small writes whose total size is known.
+  // @param bytes the number of bytes to reserve room for.
+  void Reserve(size_t bytes);
+
  protected:
   virtual uint8_t* GrowBuffer(size_t size);
 
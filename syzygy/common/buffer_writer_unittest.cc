@@ -179,4 +179,22 @@ TEST_F(BufferWriterTest, WriteToVector) {
   EXPECT_EQ(0, ::memcmp(&kExpectedData, &vector_[0], sizeof(kExpectedData)));
 }
 
+TEST_F(BufferWriterTest, ReserveVector) {
+  vector_.resize(4);
+  VectorBufferWriter writer(&vector_);
+
+  // Reserving room may reallocate the vector, but doesn't change its size.
+  writer.Reserve(sizeof(kExpectedData));
+  EXPECT_LE(sizeof(kExpectedData), vector_.capacity());
+  EXPECT_EQ(4u, vector_.size());
+  EXPECT_EQ(4u, writer.length());
+
+  // Writing within the reserved room doesn't reallocate the vector.
+  const uint8_t* data = vector_.data();
+  ASSERT_NO_FATAL_FAILURE(WriteData(&writer));
+  EXPECT_EQ(data, vector_.data());
+  EXPECT_EQ(sizeof(kExpectedData), vector_.size());
+  EXPECT_EQ(0, ::memcmp(&kExpectedData, &vector_[0], sizeof(kExpectedData)));
+}
+
 }  // namespace common
@@ -37,12 +37,15 @@
         'com_utils.cc',
         'com_utils.h',
         'comparable.h',
+        'coverage_shared_memory.h',
         'dbghelp_util.cc',
         'dbghelp_util.h',
         'defs.cc',
         'defs.h',
         'indexed_frequency_data.cc',
         'indexed_frequency_data.h',
+        'large_pages.cc',
+        'large_pages.h',
         'logging.cc',
         'logging.h',
         'path_util.cc',
@@ -81,6 +84,7 @@
         'buffer_writer_unittest.cc',
         'com_utils_unittest.cc',
         'comparable_unittest.cc',
+        'large_pages_unittest.cc',
         'path_util_unittest.cc',
         'process_utils_unittest.cc',
         'recursive_lock_unittest.cc',
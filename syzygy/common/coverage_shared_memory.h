@@ -0,0 +1,103 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the layout of the shared-memory section that the coverage agent
+// writes to when the kCoverageSharedMemoryEnvVar environment variable names
+// one. This lets an external process, such as a fuzzer or a test harness,
+// read and reset the coverage of a running process at any time, without the
+// call trace service.
+//
+// The section starts with a CoverageSharedMemoryHeader, followed by the
+// coverage arrays of the modules, each holding a byte per basic block that's
+// non-zero once the block was visited. A module is published by bumping
+// |num_modules| once its entry is filled in, and its array is never moved.
+// Readers may zero the arrays at any time to reset the coverage; the visits
+// racing with a reset are either kept or lost.
+
+#ifndef SYZYGY_COMMON_COVERAGE_SHARED_MEMORY_H_
+#define SYZYGY_COMMON_COVERAGE_SHARED_MEMORY_H_
+
+#include <windows.h>
+
+#include "syzygy/common/assertions.h"
+
+namespace common {
+
+// The environment variable holding the name of the section, as passed to
+// CreateFileMapping.
+const char kCoverageSharedMemoryEnvVar[] = "SYZYGY_COVERAGE_SHARED_MEMORY";
+
+// The size of the section, which caps the total number of basic blocks of
+// the modules.
+const size_t kCoverageSharedMemorySize = 16 * 1024 * 1024;
+
+// The maximum number of modules in the section.
+const size_t kCoverageSharedMemoryMaxModules = 64;
+
+// Identifies a section written by the coverage agent.
+const uint32_t kCoverageSharedMemorySignature = 0x56435A53;  // 'SZCV'.
+
+// This should be incremented when incompatible changes are made to the
+// layout.
+const uint32_t kCoverageSharedMemoryVersion = 1;
+
+#pragma pack(push, 1)
+
+// Describes the coverage array of an instrumented module.
+struct CoverageSharedMemoryModule {
+  // Identify the module, as in TraceModuleData.
+  uint32_t module_base_addr;
+  uint32_t module_base_size;
+  uint32_t module_checksum;
+  uint32_t module_time_date_stamp;
+
+  // The offset of the coverage array from the start of the section.
+  uint32_t data_offset;
+
+  // The number of basic blocks, which is the size of the coverage array.
+  uint32_t num_entries;
+
+  // The path of the module.
+  wchar_t module_path[MAX_PATH];
+};
+COMPILE_ASSERT_IS_POD(CoverageSharedMemoryModule);
+
+struct CoverageSharedMemoryHeader {
+  // Set to kCoverageSharedMemorySignature and kCoverageSharedMemoryVersion
+  // once the header is initialized.
+  uint32_t signature;
+  uint32_t version;
+
+  // The size of the section, in bytes.
+  uint32_t size;
+
+  // The process writing to the section.
+  uint32_t process_id;
+
+  // The number of modules published in |modules|.
+  volatile LONG num_modules;
+
+  // The offset of the end of the coverage arrays allocated so far.
+  uint32_t data_end_offset;
+
+  // The modules, of which the first |num_modules| are valid.
+  CoverageSharedMemoryModule modules[kCoverageSharedMemoryMaxModules];
+};
+COMPILE_ASSERT_IS_POD(CoverageSharedMemoryHeader);
+
+#pragma pack(pop)
+
+}  // namespace common
+
+#endif  // SYZYGY_COMMON_COVERAGE_SHARED_MEMORY_H_
@@ -15,6 +15,7 @@
 #include "syzygy/common/indexed_frequency_data.h"
 
 #include "base/logging.h"
+#include "base/strings/stringprintf.h"
 
 namespace common {
 
@@ -24,12 +25,17 @@ const uint32_t kJumpTableCountAgentId = 0x07AB1E0C;
 
 // This should be incremented when incompatible changes are made to a tracing
 // client.
-const uint32_t kBasicBlockFrequencyDataVersion = 1;
-const uint32_t kBranchFrequencyDataVersion = 1;
+const uint32_t kBasicBlockFrequencyDataVersion = 2;
+const uint32_t kBranchFrequencyDataVersion = 2;
 const uint32_t kJumpTableFrequencyDataVersion = 1;
 
 const char kBasicBlockRangesStreamName[] = "/Syzygy/BasicBlockRanges";
 
+const char kIndexedFrequencySnapshotEventEnvVar[] =
+    "SYZYGY_INDEXED_FREQUENCY_SNAPSHOT_EVENT";
+const char kIndexedFrequencySnapshotIntervalEnvVar[] =
+    "SYZYGY_INDEXED_FREQUENCY_SNAPSHOT_INTERVAL_MS";
+
 // This must be kept in sync with IndexedFrequencyDataType::DataType.
 const char* IndexedFrequencyDataTypeName[] = {
   NULL,
@@ -66,4 +72,11 @@ bool ParseFrequencyDataType(const base::StringPiece& str,
   return false;
 }
 
+std::wstring GetIndexedFrequencySnapshotEventName(
+    const base::StringPiece16& base_name, DWORD process_id) {
+  DCHECK(!base_name.empty());
+  return base::StringPrintf(L"%ls-%u", base_name.as_string().c_str(),
+                            process_id);
+}
+
 }  // namespace common
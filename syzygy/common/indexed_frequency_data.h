@@ -20,6 +20,8 @@
 
 #include <windows.h>
 
+#include <string>
+
 #include "base/strings/string_piece.h"
 #include "syzygy/common/assertions.h"
 
@@ -107,6 +109,18 @@ struct ThreadLocalIndexedFrequencyData {
   // agent. An unused slot is initialized to zero by the instrumenter, otherwise
   // it is initialized to a slot index between 1 and 4.
   DWORD fs_slot;
+
+  // The size of the per-thread counters that the instrumentation increments
+  // inline, or zero if it calls into the agent for every event. The counters
+  // saturate, and are merged into frequency_data when their thread detaches.
+  DWORD inline_counter_size;
+
+  // The implicit TLS slot holding a pointer to the current thread's inline
+  // counters. The index is written by the loader, and the slot lives at
+  //     TEB.ThreadLocalStoragePointer[inline_tls_index] + inline_tls_offset
+  // These are only meaningful if inline_counter_size is non-zero.
+  DWORD inline_tls_index;
+  DWORD inline_tls_offset;
 };
 
 #pragma pack(pop)
@@ -133,6 +147,15 @@ extern const uint32_t kJumpTableFrequencyDataVersion;
 // any instrumentation employing basic-block trace data.
 extern const char kBasicBlockRangesStreamName[];
 
+// The environment variable holding the base name of the event through which
+// snapshots of the frequency data of an instrumented process are requested.
+// Each process waits on the event named by GetIndexedFrequencySnapshotEventName.
+extern const char kIndexedFrequencySnapshotEventEnvVar[];
+
+// The environment variable holding the interval between periodic snapshots of
+// the frequency data of an instrumented process, in milliseconds.
+extern const char kIndexedFrequencySnapshotIntervalEnvVar[];
+
 // A string table mapping from DataType to text representation.
 // This array must be maintained if enum DataType is changed.
 extern const char* IndexedFrequencyDataTypeName[];
@@ -149,6 +172,15 @@ bool IndexedFrequencyDataTypeToString(IndexedFrequencyData::DataType type,
 bool ParseFrequencyDataType(const base::StringPiece& str,
                             IndexedFrequencyData::DataType* type);
 
+// Gets the name of the event through which snapshots of the frequency data of
+// a process are requested.
+// @param base_name the base name of the event, as found in the
+//     kIndexedFrequencySnapshotEventEnvVar environment variable.
+// @param process_id the ID of the instrumented process.
+// @returns the name of the event.
+std::wstring GetIndexedFrequencySnapshotEventName(
+    const base::StringPiece16& base_name, DWORD process_id);
+
 }  // namespace common
 
 #endif  // SYZYGY_COMMON_INDEXED_FREQUENCY_DATA_H_
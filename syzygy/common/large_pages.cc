@@ -0,0 +1,67 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/common/large_pages.h"
+
+#include "base/logging.h"
+#include "base/win/scoped_handle.h"
+#include "syzygy/common/com_utils.h"
+
+namespace common {
+
+namespace {
+
+bool EnableLockMemoryPrivilege() {
+  HANDLE token = NULL;
+  if (!::OpenProcessToken(::GetCurrentProcess(),
+                          TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+    DWORD error = ::GetLastError();
+    LOG(WARNING) << "OpenProcessToken failed: " << LogWe(error) << ".";
+    return false;
+  }
+  base::win::ScopedHandle scoped_token(token);
+
+  TOKEN_PRIVILEGES privileges = {};
+  privileges.PrivilegeCount = 1;
+  privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  if (!::LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+                              &privileges.Privileges[0].Luid)) {
+    DWORD error = ::GetLastError();
+    LOG(WARNING) << "LookupPrivilegeValue failed: " << LogWe(error) << ".";
+    return false;
+  }
+
+  // AdjustTokenPrivileges succeeds even if the privilege isn't held, in which
+  // case it sets ERROR_NOT_ALL_ASSIGNED.
+  if (!::AdjustTokenPrivileges(scoped_token.Get(), FALSE, &privileges, 0,
+                               NULL, NULL) ||
+      ::GetLastError() != ERROR_SUCCESS) {
+    DWORD error = ::GetLastError();
+    LOG(WARNING) << "Unable to enable the lock memory privilege: "
+                 << LogWe(error) << ".";
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+size_t EnableLargePages() {
+  static const size_t large_page_size =
+      EnableLockMemoryPrivilege() ? ::GetLargePageMinimum() : 0;
+  return large_page_size;
+}
+
+}  // namespace common
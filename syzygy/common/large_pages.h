@@ -0,0 +1,37 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Utilities for backing memory with large pages.
+
+#ifndef SYZYGY_COMMON_LARGE_PAGES_H_
+#define SYZYGY_COMMON_LARGE_PAGES_H_
+
+#include <windows.h>
+
+namespace common {
+
+// Enables the privilege needed to allocate large pages in the token of the
+// current process. This only succeeds if the user holds the privilege, which
+// is granted with the "Lock pages in memory" policy. The privilege is only
+// looked up once per process.
+// @returns the size of a large page, or 0 if large pages can't be used.
+// @note Large pages are never paged out, and must be reserved and committed
+//     at once. Callers should fall back to regular pages if this returns 0
+//     or if the large page allocation fails, as the physical memory may be
+//     too fragmented to satisfy it.
+size_t EnableLargePages();
+
+}  // namespace common
+
+#endif  // SYZYGY_COMMON_LARGE_PAGES_H_
@@ -0,0 +1,45 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/common/large_pages.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/common/align.h"
+
+namespace common {
+
+TEST(LargePagesTest, EnableLargePages) {
+  size_t large_page_size = EnableLargePages();
+
+  // The result is cached.
+  EXPECT_EQ(large_page_size, EnableLargePages());
+
+  // Large pages are usually unavailable to the test user, in which case
+  // there's nothing more to check.
+  if (large_page_size == 0)
+    return;
+  EXPECT_TRUE(IsPowerOfTwo(large_page_size));
+
+  // Large pages can be allocated, unless the physical memory is too
+  // fragmented.
+  void* mem = ::VirtualAlloc(nullptr, large_page_size,
+                             MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                             PAGE_READWRITE);
+  if (mem != nullptr) {
+    EXPECT_TRUE(IsAligned(mem, large_page_size));
+    EXPECT_TRUE(::VirtualFree(mem, 0, MEM_RELEASE));
+  }
+}
+
+}  // namespace common
@@ -19,7 +19,7 @@
 namespace common {
 
 RecursiveLock::RecursiveLock()
-    : lock_is_free_(&lock_), thread_id_(0), recursion_(0) {
+    : lock_is_free_(&lock_), thread_id_(0), recursion_(0), statistics_() {
 }
 
 void RecursiveLock::AssertAcquired() {
@@ -54,6 +54,12 @@ bool RecursiveLock::Try() {
   return TryImpl(false);
 }
 
+void RecursiveLock::GetStatistics(Statistics* statistics) {
+  DCHECK_NE(static_cast<Statistics*>(nullptr), statistics);
+  base::AutoLock lock(lock_);
+  *statistics = statistics_;
+}
+
 bool RecursiveLock::TryImpl(bool wait) {
   DWORD thread_id = ::GetCurrentThreadId();
   base::AutoLock lock(lock_);
@@ -69,17 +75,24 @@ bool RecursiveLock::TryImpl(bool wait) {
   if (!wait && thread_id_ != 0)
     return false;
 
-  // Somebody else has the lock so let's wait for them to release it.
-  while (thread_id_ != 0)
-    // This releases lock_ and waits for a signal, thus 'Acquire' does not busy
-    // loop.
-    lock_is_free_.Wait();
+  // Somebody else has the lock so let's wait for them to release it. Only the
+  // contended path reads the clock, keeping the statistics cheap.
+  if (thread_id_ != 0) {
+    base::TimeTicks wait_start = base::TimeTicks::Now();
+    while (thread_id_ != 0)
+      // This releases lock_ and waits for a signal, thus 'Acquire' does not
+      // busy loop.
+      lock_is_free_.Wait();
+    ++statistics_.contentions;
+    statistics_.wait_time += base::TimeTicks::Now() - wait_start;
+  }
 
   // Acquire the lock.
   DCHECK_EQ(0u, thread_id_);
   DCHECK_EQ(0u, recursion_);
   thread_id_ = thread_id;
   recursion_ = 1;
+  ++statistics_.acquisitions;
 
   return true;
 }
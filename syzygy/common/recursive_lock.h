@@ -20,6 +20,7 @@
 
 #include "base/synchronization/condition_variable.h"
 #include "base/synchronization/lock.h"
+#include "base/time/time.h"
 
 namespace common {
 
@@ -28,6 +29,19 @@ namespace common {
 // been released the same number of times does it return to the unlocked state.
 class RecursiveLock {
  public:
+  // Contention statistics for a lock. Only the acquisitions made by a thread
+  // that did not already own the lock are counted. These are maintained under
+  // the internal lock, which is held anyways, so they are always collected.
+  struct Statistics {
+    // The number of times the lock was acquired.
+    size_t acquisitions;
+    // The number of acquisitions that had to wait for another thread to
+    // release the lock.
+    size_t contentions;
+    // The total time spent waiting for the lock by contended acquisitions.
+    base::TimeDelta wait_time;
+  };
+
   // Constructor.
   RecursiveLock();
 
@@ -51,6 +65,10 @@ class RecursiveLock {
   // @returns the recursion count of the lock.
   size_t recursion() const { return recursion_; }
 
+  // Gets the contention statistics of this lock.
+  // @param statistics Will receive the statistics.
+  void GetStatistics(Statistics* statistics);
+
  protected:
   // The internal lock logic. Returns true if the lock is acquired, false
   // otherwise. If |wait| is true then this blocks until the lock is acquired.
@@ -65,6 +83,8 @@ class RecursiveLock {
   size_t thread_id_;
   // Holds the recursion depth. Under lock_.
   size_t recursion_;
+  // The contention statistics of this lock. Under lock_.
+  Statistics statistics_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(RecursiveLock);
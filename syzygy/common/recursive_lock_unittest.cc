@@ -122,4 +122,30 @@ TEST(RecursiveLock, StressTest) {
     threads[i]->Join();
 }
 
+TEST(RecursiveLock, Statistics) {
+  RecursiveLock lock;
+  RecursiveLock::Statistics statistics = {};
+  lock.GetStatistics(&statistics);
+  EXPECT_EQ(0u, statistics.acquisitions);
+  EXPECT_EQ(0u, statistics.contentions);
+  EXPECT_EQ(0, statistics.wait_time.InMicroseconds());
+
+  // Recursive acquisitions are only counted once.
+  lock.Acquire();
+  EXPECT_TRUE(lock.Try());
+  lock.Acquire();
+  lock.Release();
+  lock.Release();
+  lock.Release();
+  lock.GetStatistics(&statistics);
+  EXPECT_EQ(1u, statistics.acquisitions);
+  EXPECT_EQ(0u, statistics.contentions);
+
+  EXPECT_TRUE(lock.Try());
+  lock.Release();
+  lock.GetStatistics(&statistics);
+  EXPECT_EQ(2u, statistics.acquisitions);
+  EXPECT_EQ(0u, statistics.contentions);
+}
+
 }  // namespace common
@@ -0,0 +1,175 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares AddressBitmapFilter, a dense counterpart of AddressFilter which
+// keeps one bit per granule of a contiguous address space.
+
+#ifndef SYZYGY_CORE_ADDRESS_BITMAP_FILTER_H_
+#define SYZYGY_CORE_ADDRESS_BITMAP_FILTER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "syzygy/core/address_filter.h"
+
+namespace core {
+
+// An AddressBitmapFilter splits its extent into granules of a fixed size and
+// keeps a bit for each of them. Marking and querying a range only touches the
+// words holding the bits of the granules it overlaps, so queries of ranges no
+// larger than a granule are constant time, and set operations between filters
+// with the same extent and granularity are done a word at a time.
+//
+// Ranges that aren't aligned to the granularity are rounded out to the
+// granules they overlap, so the filter is only exact for aligned ranges. With
+// a granularity of 1 it is exact, at the cost of one bit per address.
+template<typename AddressType, typename SizeType>
+class AddressBitmapFilter {
+ public:
+  typedef AddressType Address;
+  typedef SizeType Size;
+  typedef AddressRange<AddressType, SizeType> Range;
+  typedef AddressFilter<AddressType, SizeType> RangeFilter;
+
+  // Default constructor. This is only for compatibility with STL containers.
+  AddressBitmapFilter() : granularity_(1), granule_count_(0) { }
+
+  // Constructor. Builds an empty filter over the given address bounds.
+  // @param extent The address-space over which this filter is defined.
+  // @param granularity The size of a granule. Must be non-zero.
+  AddressBitmapFilter(const Range& extent, Size granularity);
+
+  // Constructor. Builds a filter with the same extent and marked ranges as
+  // an AddressFilter.
+  // @param filter The filter to convert.
+  // @param granularity The size of a granule. Must be non-zero.
+  AddressBitmapFilter(const RangeFilter& filter, Size granularity);
+
+  // Clears this filter.
+  void Clear();
+
+  // Marks the granules overlapping the given address range.
+  // @param range The range to mark.
+  void Mark(const Range& range);
+
+  // Unmarks the granules overlapping the given address range.
+  // @param range The range to unmark.
+  void Unmark(const Range& range);
+
+  // Determines if the granules overlapping the given address range are all
+  // marked.
+  // @param range The address range to check.
+  // @returns false if any of the granules are not marked, or true if they
+  //     all are.
+  bool IsMarked(const Range& range) const;
+
+  // Determines if the granules overlapping the given address range are all
+  // unmarked.
+  // @param range The address range to check.
+  // @returns false if any of the granules are marked, or true if they are all
+  //     unmarked.
+  bool IsUnmarked(const Range& range) const;
+
+  // Converts this filter to an AddressFilter with the same extent.
+  // @param filter The filter to populate.
+  void ToAddressFilter(RangeFilter* filter) const;
+
+  // @name Accessors.
+  // @{
+  const Range& extent() const { return extent_; }
+  Size granularity() const { return granularity_; }
+  size_t granule_count() const { return granule_count_; }
+  bool empty() const;
+  // @}
+
+  // @name Comparison operators.
+  // @{
+  bool operator==(const AddressBitmapFilter& rhs) const {
+    return extent_ == rhs.extent_ && granularity_ == rhs.granularity_ &&
+        bits_ == rhs.bits_;
+  }
+  bool operator!=(const AddressBitmapFilter& rhs) const {
+    return !operator==(rhs);
+  }
+  // @}
+
+  // @name Set operations. The filters involved must have the same extent and
+  //     granularity.
+  // @{
+  // Inverts this filter.
+  // @param filter The filter to populate with the inverse. This may be
+  //     |this|, allowing the operation to be done in place.
+  void Invert(AddressBitmapFilter* filter) const;
+
+  // Calculates the intersection of this filter and another.
+  // @param other The filter to intersect with.
+  // @param filter The filter to populate with the intersection. This may be
+  //     |this|, allowing the operation to be done in place.
+  void Intersect(const AddressBitmapFilter& other,
+                 AddressBitmapFilter* filter) const;
+
+  // Calculates the union of this filter and another.
+  // @param other The filter with which to calculate the union.
+  // @param filter The filter to populate with the union. This may be |this|,
+  //     allowing the operation to be done in place.
+  void Union(const AddressBitmapFilter& other,
+             AddressBitmapFilter* filter) const;
+
+  // Calculates the difference between this filter and another.
+  // @param other The filter to be subtracted from this filter.
+  // @param filter The filter to populate with the difference. This may be
+  //     |this|, allowing the operation to be done in place.
+  void Subtract(const AddressBitmapFilter& other,
+                AddressBitmapFilter* filter) const;
+  // @}
+
+ protected:
+  typedef uint32_t Word;
+  static const size_t kBitsPerWord = sizeof(Word) * 8;
+
+  // Gets the granules overlapping a range.
+  // @param range The range to look up.
+  // @param begin Receives the index of the first granule.
+  // @param end Receives the index past the last granule.
+  // @returns false if the range doesn't overlap the extent, true otherwise.
+  bool GetGranules(const Range& range, size_t* begin, size_t* end) const;
+
+  // @returns the bits of the granules [@p begin, @p end) that belong to the
+  //     word at @p word_index.
+  static Word GetWordMask(size_t word_index, size_t begin, size_t end);
+
+  // Copies the extent and granularity of this filter to @p filter, and sizes
+  // its bitmap accordingly.
+  void PrepareResult(AddressBitmapFilter* filter) const;
+
+  // The extents of this filter.
+  Range extent_;
+
+  // The size of a granule.
+  Size granularity_;
+
+  // The number of granules in the extent.
+  size_t granule_count_;
+
+  // One bit per granule. The bits past the last granule are always clear.
+  std::vector<Word> bits_;
+};
+
+}  // namespace core
+
+// Bring in the implementation.
+#include "syzygy/core/address_bitmap_filter_impl.h"
+
+#endif  // SYZYGY_CORE_ADDRESS_BITMAP_FILTER_H_
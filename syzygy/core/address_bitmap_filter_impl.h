@@ -0,0 +1,256 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Implementation details of core::AddressBitmapFilter. This is only meant to
+// be included directly from syzygy/core/address_bitmap_filter.h.
+
+#ifndef SYZYGY_CORE_ADDRESS_BITMAP_FILTER_IMPL_H_
+#define SYZYGY_CORE_ADDRESS_BITMAP_FILTER_IMPL_H_
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace core {
+
+template<typename AddressType, typename SizeType>
+AddressBitmapFilter<AddressType, SizeType>::AddressBitmapFilter(
+    const Range& extent, Size granularity)
+    : extent_(extent),
+      granularity_(granularity),
+      granule_count_((extent.size() + granularity - 1) / granularity),
+      bits_((granule_count_ + kBitsPerWord - 1) / kBitsPerWord, 0) {
+  DCHECK_LT(0u, granularity);
+}
+
+template<typename AddressType, typename SizeType>
+AddressBitmapFilter<AddressType, SizeType>::AddressBitmapFilter(
+    const RangeFilter& filter, Size granularity)
+    : extent_(filter.extent()),
+      granularity_(granularity),
+      granule_count_((extent_.size() + granularity - 1) / granularity),
+      bits_((granule_count_ + kBitsPerWord - 1) / kBitsPerWord, 0) {
+  DCHECK_LT(0u, granularity);
+  for (const auto& range : filter.marked_ranges())
+    Mark(range);
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::Clear() {
+  std::fill(bits_.begin(), bits_.end(), 0);
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::Mark(const Range& range) {
+  size_t begin = 0;
+  size_t end = 0;
+  if (!GetGranules(range, &begin, &end))
+    return;
+
+  size_t last_word = (end - 1) / kBitsPerWord;
+  for (size_t i = begin / kBitsPerWord; i <= last_word; ++i)
+    bits_[i] |= GetWordMask(i, begin, end);
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::Unmark(const Range& range) {
+  size_t begin = 0;
+  size_t end = 0;
+  if (!GetGranules(range, &begin, &end))
+    return;
+
+  size_t last_word = (end - 1) / kBitsPerWord;
+  for (size_t i = begin / kBitsPerWord; i <= last_word; ++i)
+    bits_[i] &= ~GetWordMask(i, begin, end);
+}
+
+template<typename AddressType, typename SizeType>
+bool AddressBitmapFilter<AddressType, SizeType>::IsMarked(
+    const Range& range) const {
+  // Anything that falls outside of the extent is by definition not marked.
+  size_t begin = 0;
+  size_t end = 0;
+  if (!GetGranules(range, &begin, &end))
+    return false;
+
+  size_t last_word = (end - 1) / kBitsPerWord;
+  for (size_t i = begin / kBitsPerWord; i <= last_word; ++i) {
+    Word mask = GetWordMask(i, begin, end);
+    if ((bits_[i] & mask) != mask)
+      return false;
+  }
+
+  return true;
+}
+
+template<typename AddressType, typename SizeType>
+bool AddressBitmapFilter<AddressType, SizeType>::IsUnmarked(
+    const Range& range) const {
+  // Anything that falls outside of the extent is by definition not marked.
+  size_t begin = 0;
+  size_t end = 0;
+  if (!GetGranules(range, &begin, &end))
+    return true;
+
+  size_t last_word = (end - 1) / kBitsPerWord;
+  for (size_t i = begin / kBitsPerWord; i <= last_word; ++i) {
+    if ((bits_[i] & GetWordMask(i, begin, end)) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::ToAddressFilter(
+    RangeFilter* filter) const {
+  DCHECK(filter != NULL);
+
+  *filter = RangeFilter(extent_);
+
+  // Mark each run of marked granules, skipping over empty words.
+  size_t run_begin = 0;
+  bool in_run = false;
+  for (size_t i = 0; i < granule_count_; ++i) {
+    Word word = bits_[i / kBitsPerWord];
+    if (!in_run && word == 0 && i % kBitsPerWord == 0) {
+      i += kBitsPerWord - 1;
+      continue;
+    }
+
+    bool marked = (word & (1u << (i % kBitsPerWord))) != 0;
+    if (marked && !in_run) {
+      run_begin = i;
+      in_run = true;
+    } else if (!marked && in_run) {
+      filter->Mark(Range(extent_.start() + run_begin * granularity_,
+                         (i - run_begin) * granularity_));
+      in_run = false;
+    }
+  }
+
+  // The last granule may extend past the extent. This is clipped by Mark.
+  if (in_run) {
+    filter->Mark(Range(extent_.start() + run_begin * granularity_,
+                       (granule_count_ - run_begin) * granularity_));
+  }
+}
+
+template<typename AddressType, typename SizeType>
+bool AddressBitmapFilter<AddressType, SizeType>::empty() const {
+  for (Word word : bits_) {
+    if (word != 0)
+      return false;
+  }
+  return true;
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::Invert(
+    AddressBitmapFilter* filter) const {
+  DCHECK(filter != NULL);
+
+  PrepareResult(filter);
+  for (size_t i = 0; i < bits_.size(); ++i)
+    filter->bits_[i] = ~bits_[i];
+
+  // Keep the bits past the last granule clear.
+  if (granule_count_ % kBitsPerWord != 0) {
+    filter->bits_.back() &= GetWordMask(
+        bits_.size() - 1, (bits_.size() - 1) * kBitsPerWord, granule_count_);
+  }
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::Intersect(
+    const AddressBitmapFilter& other, AddressBitmapFilter* filter) const {
+  DCHECK(filter != NULL);
+  DCHECK(extent_ == other.extent_);
+  DCHECK_EQ(granularity_, other.granularity_);
+
+  PrepareResult(filter);
+  for (size_t i = 0; i < bits_.size(); ++i)
+    filter->bits_[i] = bits_[i] & other.bits_[i];
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::Union(
+    const AddressBitmapFilter& other, AddressBitmapFilter* filter) const {
+  DCHECK(filter != NULL);
+  DCHECK(extent_ == other.extent_);
+  DCHECK_EQ(granularity_, other.granularity_);
+
+  PrepareResult(filter);
+  for (size_t i = 0; i < bits_.size(); ++i)
+    filter->bits_[i] = bits_[i] | other.bits_[i];
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::Subtract(
+    const AddressBitmapFilter& other, AddressBitmapFilter* filter) const {
+  DCHECK(filter != NULL);
+  DCHECK(extent_ == other.extent_);
+  DCHECK_EQ(granularity_, other.granularity_);
+
+  PrepareResult(filter);
+  for (size_t i = 0; i < bits_.size(); ++i)
+    filter->bits_[i] = bits_[i] & ~other.bits_[i];
+}
+
+template<typename AddressType, typename SizeType>
+bool AddressBitmapFilter<AddressType, SizeType>::GetGranules(
+    const Range& range, size_t* begin, size_t* end) const {
+  DCHECK(begin != NULL);
+  DCHECK(end != NULL);
+
+  Range r;
+  if (!internal::Intersect(extent_, range, &r))
+    return false;
+
+  *begin = static_cast<size_t>(r.start() - extent_.start()) / granularity_;
+  *end = (static_cast<size_t>(r.end() - extent_.start()) + granularity_ - 1) /
+      granularity_;
+  DCHECK_LT(*begin, *end);
+  DCHECK_LE(*end, granule_count_);
+
+  return true;
+}
+
+template<typename AddressType, typename SizeType>
+typename AddressBitmapFilter<AddressType, SizeType>::Word
+AddressBitmapFilter<AddressType, SizeType>::GetWordMask(
+    size_t word_index, size_t begin, size_t end) {
+  size_t word_begin = word_index * kBitsPerWord;
+  size_t first = std::max(begin, word_begin) - word_begin;
+  size_t last = std::min(end, word_begin + kBitsPerWord) - word_begin;
+  DCHECK_LT(first, last);
+
+  if (last - first == kBitsPerWord)
+    return ~static_cast<Word>(0);
+  return ((static_cast<Word>(1) << (last - first)) - 1) << first;
+}
+
+template<typename AddressType, typename SizeType>
+void AddressBitmapFilter<AddressType, SizeType>::PrepareResult(
+    AddressBitmapFilter* filter) const {
+  DCHECK(filter != NULL);
+  filter->extent_ = extent_;
+  filter->granularity_ = granularity_;
+  filter->granule_count_ = granule_count_;
+  filter->bits_.resize(bits_.size());
+}
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_ADDRESS_BITMAP_FILTER_IMPL_H_
@@ -0,0 +1,170 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/address_bitmap_filter.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/core/address.h"
+
+namespace core {
+
+namespace {
+
+typedef AddressBitmapFilter<AbsoluteAddress, size_t> TestBitmapFilter;
+typedef TestBitmapFilter::Range Range;
+typedef TestBitmapFilter::RangeFilter TestAddressFilter;
+
+// A handy little factory.
+Range MakeRange(size_t address, size_t size) {
+  return Range(AbsoluteAddress(address), size);
+}
+
+}  // namespace
+
+TEST(AddressBitmapFilterTest, DefaultConstructor) {
+  TestBitmapFilter f;
+  EXPECT_EQ(Range(), f.extent());
+  EXPECT_EQ(0u, f.granule_count());
+  EXPECT_TRUE(f.empty());
+
+  // Marking a range should be a noop.
+  f.Mark(MakeRange(0, 100));
+  EXPECT_TRUE(f.empty());
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(0, 100)));
+}
+
+TEST(AddressBitmapFilterTest, RangeConstructor) {
+  TestBitmapFilter f(MakeRange(100, 1000), 16);
+  EXPECT_EQ(MakeRange(100, 1000), f.extent());
+  EXPECT_EQ(16u, f.granularity());
+  EXPECT_EQ(63u, f.granule_count());
+  EXPECT_TRUE(f.empty());
+}
+
+TEST(AddressBitmapFilterTest, MarkAndUnmark) {
+  TestBitmapFilter f(MakeRange(0, 1000), 1);
+
+  // Ranges outside of the extent are ignored, and straddling ones clipped.
+  f.Mark(MakeRange(2000, 10));
+  EXPECT_TRUE(f.empty());
+  f.Mark(MakeRange(990, 100));
+  EXPECT_TRUE(f.IsMarked(MakeRange(990, 10)));
+  EXPECT_FALSE(f.IsMarked(MakeRange(989, 2)));
+  EXPECT_FALSE(f.IsMarked(MakeRange(1000, 1)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(1000, 1)));
+
+  // A range spanning several words.
+  f.Mark(MakeRange(10, 100));
+  EXPECT_TRUE(f.IsMarked(MakeRange(10, 100)));
+  EXPECT_TRUE(f.IsMarked(MakeRange(40, 10)));
+  EXPECT_FALSE(f.IsMarked(MakeRange(9, 2)));
+  EXPECT_FALSE(f.IsMarked(MakeRange(109, 2)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(0, 10)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(110, 100)));
+  EXPECT_FALSE(f.IsUnmarked(MakeRange(0, 11)));
+  EXPECT_FALSE(f.IsUnmarked(MakeRange(109, 100)));
+
+  // Punch a hole in it.
+  f.Unmark(MakeRange(30, 40));
+  EXPECT_TRUE(f.IsMarked(MakeRange(10, 20)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(30, 40)));
+  EXPECT_TRUE(f.IsMarked(MakeRange(70, 40)));
+  EXPECT_FALSE(f.IsMarked(MakeRange(10, 100)));
+  EXPECT_FALSE(f.IsUnmarked(MakeRange(10, 100)));
+
+  f.Clear();
+  EXPECT_TRUE(f.empty());
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(0, 1000)));
+}
+
+TEST(AddressBitmapFilterTest, Granularity) {
+  TestBitmapFilter f(MakeRange(0, 1000), 16);
+
+  // Unaligned ranges are rounded out to whole granules.
+  f.Mark(MakeRange(20, 1));
+  EXPECT_TRUE(f.IsMarked(MakeRange(16, 16)));
+  EXPECT_FALSE(f.IsUnmarked(MakeRange(31, 1)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(0, 16)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(32, 16)));
+
+  f.Unmark(MakeRange(31, 2));
+  EXPECT_TRUE(f.empty());
+
+  // The last granule is partial.
+  f.Mark(MakeRange(999, 1));
+  EXPECT_TRUE(f.IsMarked(MakeRange(992, 8)));
+}
+
+TEST(AddressBitmapFilterTest, ConvertFromAndToAddressFilter) {
+  TestAddressFilter ranges(MakeRange(100, 1000));
+  ranges.Mark(MakeRange(100, 10));
+  ranges.Mark(MakeRange(150, 100));
+  ranges.Mark(MakeRange(1090, 10));
+
+  TestBitmapFilter f(ranges, 1);
+  EXPECT_EQ(ranges.extent(), f.extent());
+  EXPECT_TRUE(f.IsMarked(MakeRange(100, 10)));
+  EXPECT_TRUE(f.IsMarked(MakeRange(150, 100)));
+  EXPECT_TRUE(f.IsMarked(MakeRange(1090, 10)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(110, 40)));
+  EXPECT_TRUE(f.IsUnmarked(MakeRange(250, 840)));
+
+  TestAddressFilter converted;
+  f.ToAddressFilter(&converted);
+  EXPECT_EQ(ranges, converted);
+
+  // A coarse bitmap marks the granules overlapping the ranges.
+  TestBitmapFilter coarse(ranges, 64);
+  coarse.ToAddressFilter(&converted);
+  TestAddressFilter expected(MakeRange(100, 1000));
+  expected.Mark(MakeRange(100, 64 * 3));
+  expected.Mark(MakeRange(100 + 64 * 15, 1000 - 64 * 15));
+  EXPECT_EQ(expected, converted);
+}
+
+TEST(AddressBitmapFilterTest, SetOperations) {
+  TestBitmapFilter f1(MakeRange(0, 100), 1);
+  f1.Mark(MakeRange(10, 40));
+  TestBitmapFilter f2(MakeRange(0, 100), 1);
+  f2.Mark(MakeRange(30, 40));
+
+  TestBitmapFilter result;
+  f1.Invert(&result);
+  EXPECT_TRUE(result.IsMarked(MakeRange(0, 10)));
+  EXPECT_TRUE(result.IsUnmarked(MakeRange(10, 40)));
+  EXPECT_TRUE(result.IsMarked(MakeRange(50, 50)));
+  result.Invert(&result);
+  EXPECT_EQ(f1, result);
+
+  f1.Intersect(f2, &result);
+  TestBitmapFilter expected(MakeRange(0, 100), 1);
+  expected.Mark(MakeRange(30, 20));
+  EXPECT_EQ(expected, result);
+
+  f1.Union(f2, &result);
+  expected.Clear();
+  expected.Mark(MakeRange(10, 60));
+  EXPECT_EQ(expected, result);
+
+  f1.Subtract(f2, &result);
+  expected.Clear();
+  expected.Mark(MakeRange(10, 20));
+  EXPECT_EQ(expected, result);
+
+  // In place.
+  f1.Subtract(f2, &f1);
+  EXPECT_EQ(expected, f1);
+}
+
+}  // namespace core
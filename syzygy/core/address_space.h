@@ -59,6 +59,10 @@ class AddressSpace {
   // Create an empty address space.
   AddressSpace();
 
+  // Copies an address space. The copy is never frozen.
+  AddressSpace(const AddressSpace& other);
+  AddressSpace& operator=(const AddressSpace& other);
+
   // Insert @p range mapping to @p item unless @p range intersects
   // an existing range.
   // @param range the range to insert.
@@ -132,12 +136,32 @@ class AddressSpace {
   // Returns true iff @p range is removed.
   bool Remove(const Range& range);
   // Remove the item at position @p it.
-  void Remove(RangeMapIter it) { ranges_.erase(it); }
+  void Remove(RangeMapIter it) {
+    Thaw();
+    ranges_.erase(it);
+  }
   // Remove the items in the given range.
-  void Remove(RangeMapIterPair its) { ranges_.erase(its.first, its.second); }
-  void Remove(RangeMapIter it1, RangeMapIter it2) { ranges_.erase(it1, it2); }
+  void Remove(RangeMapIterPair its) { Remove(its.first, its.second); }
+  void Remove(RangeMapIter it1, RangeMapIter it2) {
+    Thaw();
+    ranges_.erase(it1, it2);
+  }
   // Remove all items from the address space.
-  void Clear() { ranges_.clear(); }
+  void Clear() {
+    Thaw();
+    ranges_.clear();
+  }
+
+  // Builds a sorted array index of the ranges, through which the lookup
+  // functions binary search contiguous memory instead of chasing the nodes of
+  // the map. This pays off for read-mostly phases, as it costs a pass over
+  // the ranges. Any modification of the address space thaws it, dropping the
+  // index; iterators remain valid throughout.
+  void Freeze();
+  // Drops the index built by Freeze.
+  void Thaw();
+  // @returns true if the address space is frozen.
+  bool frozen() const { return frozen_; }
 
   const RangeMap& ranges() const { return ranges_; }
   const bool empty() const { return ranges_.empty(); }
@@ -189,6 +213,12 @@ class AddressSpace {
  private:
   // Our ranges and their associated items.
   RangeMap ranges_;
+
+  // The lookup index, valid while frozen. These hold the end address and the
+  // iterator of each range, in address order.
+  bool frozen_;
+  std::vector<AddressType> ends_;
+  std::vector<RangeMapIter> index_;
 };
 
 // An AddressRangeMap is used for keeping track of data in one address space
@@ -385,8 +415,75 @@ class AddressRangeMap {
   RangePairs range_pairs_;
 };
 
+// Collects pairs of ranges in any order, and builds an AddressRangeMap from
+// them in one pass. This is O(N log N) in the number of pairs, whereas calling
+// AddressRangeMap::Insert for each of them moves O(N) pairs per call in the
+// worst case.
+//
+// Contiguous mappings dominate in practice, so a pair that extends the last
+// added pair linearly (see AddressRangeMap) is merged into it as it is added.
+// A long run of such pairs is thus stored as a single pair.
+template <typename SourceRangeType, typename DestinationRangeType>
+class AddressRangeMapBuilder {
+ public:
+  typedef AddressRangeMap<SourceRangeType, DestinationRangeType> RangeMap;
+  typedef typename RangeMap::SourceRange SourceRange;
+  typedef typename RangeMap::DestinationRange DestinationRange;
+  typedef typename RangeMap::RangePair RangePair;
+  typedef typename RangeMap::RangePairs RangePairs;
+
+  // @returns the pairs collected so far, in the order they were added. Runs
+  //     of contiguous pairs are merged.
+  const RangePairs& range_pairs() const { return range_pairs_; }
+  void clear() { range_pairs_.clear(); }
+  bool empty() const { return range_pairs_.empty(); }
+  size_t size() const { return range_pairs_.size(); }
+
+  // Reserves room for @p count pairs.
+  void reserve(size_t count) { range_pairs_.reserve(count); }
+
+  // Adds a pair of ranges. This is amortized O(1).
+  //
+  // @param src_range the source range of the mapping to be added.
+  // @param dst_range the destination range of the mapping to be added.
+  // @returns true on success, false if either range is empty.
+  bool Add(const SourceRange& src_range, const DestinationRange& dst_range);
+
+  // Builds an address range map from the collected pairs, and clears the
+  // builder. The pairs are considered by increasing start address, then by
+  // increasing length, and those whose source range intersects that of a
+  // pair already kept are dropped.
+  //
+  // @param range_map the map to populate. Its previous contents are
+  //     discarded.
+  // @returns the number of pairs that were dropped because of conflicts.
+  size_t Build(RangeMap* range_map);
+
+ private:
+  // Stores the collected pairs.
+  RangePairs range_pairs_;
+};
+
+template <typename AddressType, typename SizeType, typename ItemType>
+AddressSpace<AddressType, SizeType, ItemType>::AddressSpace()
+    : frozen_(false) {
+}
+
 template <typename AddressType, typename SizeType, typename ItemType>
-AddressSpace<AddressType, SizeType, ItemType>::AddressSpace() {
+AddressSpace<AddressType, SizeType, ItemType>::AddressSpace(
+    const AddressSpace& other)
+    : ranges_(other.ranges_), frozen_(false) {
+}
+
+template <typename AddressType, typename SizeType, typename ItemType>
+AddressSpace<AddressType, SizeType, ItemType>&
+AddressSpace<AddressType, SizeType, ItemType>::operator=(
+    const AddressSpace& other) {
+  if (this != &other) {
+    Thaw();
+    ranges_ = other.ranges_;
+  }
+  return *this;
 }
 
 template <typename AddressType, typename SizeType, typename ItemType>
@@ -403,6 +500,7 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Insert(
   if (it != ranges_.end())
     return false;
 
+  Thaw();
   std::pair<RangeMap::iterator, bool> inserted =
       ranges_.insert(std::make_pair(range, item));
   DCHECK(inserted.second);
@@ -430,6 +528,7 @@ bool AddressSpace<AddressType, SizeType, ItemType>::FindOrInsert(
     return range == it->first && item == it->second;
   }
 
+  Thaw();
   std::pair<RangeMap::iterator, bool> inserted =
       ranges_.insert(std::make_pair(range, item));
   DCHECK(inserted.second);
@@ -484,6 +583,7 @@ bool AddressSpace<AddressType, SizeType, ItemType>::SubsumeInsert(
       return false;
   }
 
+  Thaw();
   ranges_.erase(its.first, its.second);
 
   std::pair<RangeMap::iterator, bool> inserted =
@@ -509,6 +609,8 @@ void AddressSpace<AddressType, SizeType, ItemType>::MergeInsert(
   AddressType start_addr = range.start();
   size_t length = range.size();
 
+  Thaw();
+
   // Have overlap with existing blocks?
   if (its.first != its.second) {
     // Find start address of new block. This is the min of the requested range,
@@ -550,10 +652,38 @@ bool AddressSpace<AddressType, SizeType, ItemType>::Remove(const Range& range) {
   if (it == ranges_.end())
     return false;
 
+  Thaw();
   ranges_.erase(it);
   return true;
 }
 
+template <typename AddressType, typename SizeType, typename ItemType>
+void AddressSpace<AddressType, SizeType, ItemType>::Freeze() {
+  if (frozen_)
+    return;
+
+  ends_.reserve(ranges_.size());
+  index_.reserve(ranges_.size());
+  RangeMapIter it = ranges_.begin();
+  for (; it != ranges_.end(); ++it) {
+    ends_.push_back(it->first.end());
+    index_.push_back(it);
+  }
+  frozen_ = true;
+}
+
+template <typename AddressType, typename SizeType, typename ItemType>
+void AddressSpace<AddressType, SizeType, ItemType>::Thaw() {
+  if (!frozen_)
+    return;
+
+  // Release the memory of the index rather than merely clearing it, as the
+  // address space may well be modified at length before being frozen again.
+  std::vector<AddressType>().swap(ends_);
+  std::vector<RangeMapIter>().swap(index_);
+  frozen_ = false;
+}
+
 template <typename AddressType, typename SizeType, typename ItemType>
 typename AddressSpace<AddressType, SizeType, ItemType>::RangeMap::const_iterator
 AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
@@ -569,6 +699,17 @@ AddressSpace<AddressType, SizeType, ItemType>::FindFirstIntersection(
   if (range.IsEmpty())
     return ranges_.end();
 
+  if (frozen_) {
+    // The ranges don't overlap, so their ends are sorted like their starts.
+    // The first range that ends after the start of @p range is the only
+    // candidate.
+    size_t i = std::upper_bound(ends_.begin(), ends_.end(), range.start()) -
+        ends_.begin();
+    if (i < index_.size() && index_[i]->first.start() < range.end())
+      return index_[i];
+    return ranges_.end();
+  }
+
   RangeMap::iterator it(ranges_.lower_bound(range));
 
   // There are three cases we need to handle here:
@@ -612,8 +753,19 @@ AddressSpace<AddressType, SizeType, ItemType>::FindIntersecting(
   RangeMap::iterator begin(FindFirstIntersection(range));
 
   // Then the end.
-  RangeMap::iterator end(ranges_.lower_bound(
-      Range(range.start() + range.size(), 1)));
+  RangeMap::iterator end(ranges_.end());
+  if (frozen_) {
+    // The first range that ends beyond @p range may still straddle its end,
+    // in which case the one after it is the end.
+    size_t i = std::upper_bound(ends_.begin(), ends_.end(), range.end()) -
+        ends_.begin();
+    if (i < index_.size() && index_[i]->first.start() < range.end())
+      ++i;
+    if (i < index_.size())
+      end = index_[i];
+  } else {
+    end = ranges_.lower_bound(Range(range.start() + range.size(), 1));
+  }
 
   // Ensure that the relationship begin <= end holds, so that we may always
   // iterate over the returned range. It is possible that begin == end(),
@@ -1106,6 +1258,57 @@ void AddressRangeMap<SourceRangeType, DestinationRangeType>::
                        range_pairs_.begin() + end_affected_ranges);
 }
 
+template <typename SourceRangeType, typename DestinationRangeType>
+bool AddressRangeMapBuilder<SourceRangeType, DestinationRangeType>::Add(
+    const SourceRange& src_range, const DestinationRange& dst_range) {
+  // We can't add empty ranges.
+  if (src_range.IsEmpty() || dst_range.IsEmpty())
+    return false;
+
+  // Can we extend the run of the last pair?
+  if (!range_pairs_.empty()) {
+    SourceRange& last_src_range = range_pairs_.back().first;
+    DestinationRange& last_dst_range = range_pairs_.back().second;
+    if (last_src_range.size() == last_dst_range.size() &&
+        src_range.size() == dst_range.size() &&
+        last_src_range.end() == src_range.start() &&
+        last_dst_range.end() == dst_range.start()) {
+      last_src_range = SourceRange(
+          last_src_range.start(), last_src_range.size() + src_range.size());
+      last_dst_range = DestinationRange(
+          last_dst_range.start(), last_dst_range.size() + dst_range.size());
+      return true;
+    }
+  }
+
+  range_pairs_.push_back(std::make_pair(src_range, dst_range));
+  return true;
+}
+
+template <typename SourceRangeType, typename DestinationRangeType>
+size_t AddressRangeMapBuilder<SourceRangeType, DestinationRangeType>::Build(
+    RangeMap* range_map) {
+  DCHECK(range_map != NULL);
+
+  // Sort the pairs with a total ordering, so that conflicts are resolved
+  // deterministically. This is a no-op if they were added in order.
+  typedef internal::CompleteAddressRangePairLess<SourceRangeType,
+                                                 DestinationRangeType> Less;
+  if (!std::is_sorted(range_pairs_.begin(), range_pairs_.end(), Less()))
+    std::sort(range_pairs_.begin(), range_pairs_.end(), Less());
+
+  // Push the pairs in order, which merges the runs that are now adjacent.
+  size_t conflicts = 0;
+  range_map->clear();
+  for (size_t i = 0; i < range_pairs_.size(); ++i) {
+    if (!range_map->Push(range_pairs_[i].first, range_pairs_[i].second))
+      ++conflicts;
+  }
+
+  range_pairs_.clear();
+  return conflicts;
+}
+
 // An ostream operator for AddressRanges.
 template<typename AddressType, typename SizeType>
 std::ostream& operator<<(
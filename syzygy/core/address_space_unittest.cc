@@ -25,6 +25,8 @@ typedef AddressRange<size_t, size_t> IntegerRange;
 typedef AddressRangeMap<IntegerRange, IntegerRange> IntegerRangeMap;
 typedef IntegerRangeMap::RangePair IntegerRangePair;
 typedef IntegerRangeMap::RangePairs IntegerRangePairs;
+typedef AddressRangeMapBuilder<IntegerRange, IntegerRange>
+    IntegerRangeMapBuilder;
 
 namespace {
 
@@ -396,6 +398,68 @@ TEST(AddressSpaceTest, FindIntersecting) {
   EXPECT_TRUE(it_pair.first == address_space.ranges().end());
 }
 
+TEST(AddressSpaceTest, Freeze) {
+  IntegerAddressSpace address_space;
+  void* item = "Something to point at";
+
+  EXPECT_TRUE(address_space.Insert(IntegerAddressSpace::Range(100, 10), item));
+  EXPECT_TRUE(address_space.Insert(IntegerAddressSpace::Range(110, 5), item));
+  EXPECT_TRUE(address_space.Insert(IntegerAddressSpace::Range(120, 10), item));
+  EXPECT_FALSE(address_space.frozen());
+
+  // Record the lookups of the thawed address space.
+  typedef std::pair<size_t, size_t> Query;
+  std::vector<Query> queries;
+  std::vector<IntegerAddressSpace::RangeMapIter> first_intersections;
+  std::vector<IntegerAddressSpace::RangeMapIterPair> intersections;
+  std::vector<IntegerAddressSpace::RangeMapIter> containing;
+  for (size_t start = 90; start < 140; ++start) {
+    for (size_t size = 0; size < 45; ++size) {
+      IntegerAddressSpace::Range range(start, size);
+      queries.push_back(Query(start, size));
+      first_intersections.push_back(
+          address_space.FindFirstIntersection(range));
+      intersections.push_back(address_space.FindIntersecting(range));
+      containing.push_back(address_space.FindContaining(range));
+    }
+  }
+
+  // The frozen address space yields the same results.
+  address_space.Freeze();
+  EXPECT_TRUE(address_space.frozen());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    IntegerAddressSpace::Range range(queries[i].first, queries[i].second);
+    EXPECT_TRUE(first_intersections[i] ==
+                address_space.FindFirstIntersection(range));
+    EXPECT_TRUE(intersections[i] == address_space.FindIntersecting(range));
+    EXPECT_TRUE(containing[i] == address_space.FindContaining(range));
+  }
+
+  // Copies aren't frozen.
+  IntegerAddressSpace copy(address_space);
+  EXPECT_FALSE(copy.frozen());
+  EXPECT_EQ(3u, copy.size());
+
+  // Failed insertions leave it frozen, modifications thaw it.
+  EXPECT_FALSE(address_space.Insert(IntegerAddressSpace::Range(105, 10),
+                                    item));
+  EXPECT_TRUE(address_space.frozen());
+  EXPECT_TRUE(address_space.Insert(IntegerAddressSpace::Range(115, 5), item));
+  EXPECT_FALSE(address_space.frozen());
+  EXPECT_TRUE(address_space.Contains(IntegerAddressSpace::Range(116, 2)));
+
+  address_space.Freeze();
+  EXPECT_TRUE(address_space.Contains(IntegerAddressSpace::Range(116, 2)));
+  EXPECT_TRUE(address_space.Remove(IntegerAddressSpace::Range(115, 5)));
+  EXPECT_FALSE(address_space.frozen());
+  EXPECT_FALSE(address_space.Intersects(IntegerAddressSpace::Range(116, 2)));
+
+  address_space.Freeze();
+  address_space.Clear();
+  EXPECT_FALSE(address_space.frozen());
+  EXPECT_TRUE(address_space.empty());
+}
+
 TEST(AddressRangeMapTest, IsSimple) {
   IntegerRangeMap map;
   EXPECT_FALSE(map.IsSimple());
@@ -907,4 +971,77 @@ TEST(AddressRangeMapTest, RemoveMappedBeyondEnd) {
   EXPECT_THAT(expected, testing::ContainerEq(map.range_pairs()));
 }
 
+TEST(AddressRangeMapBuilderTest, AddMergesRuns) {
+  IntegerRangeMapBuilder builder;
+  EXPECT_TRUE(builder.empty());
+  EXPECT_FALSE(builder.Add(IntegerRange(0, 0), IntegerRange(1000, 10)));
+  EXPECT_FALSE(builder.Add(IntegerRange(0, 10), IntegerRange(1000, 0)));
+  EXPECT_TRUE(builder.empty());
+
+  // Contiguous linear pairs are merged into a single run.
+  EXPECT_TRUE(builder.Add(IntegerRange(0, 10), IntegerRange(1000, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(10, 10), IntegerRange(1010, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(20, 5), IntegerRange(1020, 5)));
+  EXPECT_EQ(1u, builder.size());
+
+  // Non-contiguous and non-linear pairs aren't.
+  EXPECT_TRUE(builder.Add(IntegerRange(30, 10), IntegerRange(1030, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(40, 10), IntegerRange(1040, 20)));
+  EXPECT_EQ(3u, builder.size());
+
+  IntegerRangePairs expected;
+  expected.push_back(
+      IntegerRangePair(IntegerRange(0, 25), IntegerRange(1000, 25)));
+  expected.push_back(
+      IntegerRangePair(IntegerRange(30, 10), IntegerRange(1030, 10)));
+  expected.push_back(
+      IntegerRangePair(IntegerRange(40, 10), IntegerRange(1040, 20)));
+  EXPECT_THAT(expected, testing::ContainerEq(builder.range_pairs()));
+}
+
+TEST(AddressRangeMapBuilderTest, BuildOutOfOrder) {
+  IntegerRangeMapBuilder builder;
+  EXPECT_TRUE(builder.Add(IntegerRange(40, 10), IntegerRange(1040, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(0, 10), IntegerRange(1000, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(20, 10), IntegerRange(1020, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(10, 10), IntegerRange(1010, 10)));
+
+  // The build matches inserting the pairs one at a time.
+  IntegerRangeMap expected;
+  for (size_t i = 0; i < builder.size(); ++i) {
+    ASSERT_TRUE(expected.Insert(builder.range_pairs()[i].first,
+                                builder.range_pairs()[i].second));
+  }
+
+  IntegerRangeMap map;
+  ASSERT_TRUE(map.Push(IntegerRange(100, 10), IntegerRange(0, 10)));
+  EXPECT_EQ(0u, builder.Build(&map));
+  EXPECT_EQ(expected, map);
+  EXPECT_EQ(2u, map.size());
+  EXPECT_TRUE(builder.empty());
+
+  // Building with nothing collected empties the map.
+  EXPECT_EQ(0u, builder.Build(&map));
+  EXPECT_TRUE(map.empty());
+}
+
+TEST(AddressRangeMapBuilderTest, BuildWithConflicts) {
+  IntegerRangeMapBuilder builder;
+  EXPECT_TRUE(builder.Add(IntegerRange(5, 10), IntegerRange(2000, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(0, 10), IntegerRange(1000, 10)));
+  EXPECT_TRUE(builder.Add(IntegerRange(0, 5), IntegerRange(3000, 5)));
+
+  // The shorter range at the earliest address wins, and the range after it
+  // no longer conflicts.
+  IntegerRangeMap map;
+  EXPECT_EQ(1u, builder.Build(&map));
+
+  IntegerRangePairs expected;
+  expected.push_back(
+      IntegerRangePair(IntegerRange(0, 5), IntegerRange(3000, 5)));
+  expected.push_back(
+      IntegerRangePair(IntegerRange(5, 10), IntegerRange(2000, 10)));
+  EXPECT_THAT(expected, testing::ContainerEq(map.range_pairs()));
+}
+
 }  // namespace core
@@ -23,6 +23,8 @@
       'sources': [
         'address.cc',
         'address.h',
+        'address_bitmap_filter.h',
+        'address_bitmap_filter_impl.h',
         'address_filter.h',
         'address_filter_impl.h',
         'address_range.cc',
@@ -38,6 +40,8 @@
         'file_util.h',
         'json_file_writer.cc',
         'json_file_writer.h',
+        'phase_profiler.cc',
+        'phase_profiler.h',
         'random_number_generator.cc',
         'random_number_generator.h',
         'section_offset_address.cc',
@@ -57,6 +61,11 @@
         '<(src)/third_party/distorm/distorm.gyp:distorm',
         '<(src)/third_party/zlib/zlib.gyp:zlib',
       ],
+      'link_settings': {
+        'libraries': [
+          'psapi.lib',
+        ],
+      },
     },
     {
       'target_name': 'core_unittest_utils',
@@ -77,6 +86,7 @@
       'includes': ['../build/masm.gypi'],
       'sources': [
         'address_unittest.cc',
+        'address_bitmap_filter_unittest.cc',
         'address_filter_unittest.cc',
         'address_space_unittest.cc',
         'address_range_unittest.cc',
@@ -87,6 +97,7 @@
         'disassembler_util_unittest_vex_utils.h',
         'file_util_unittest.cc',
         'json_file_writer_unittest.cc',
+        'phase_profiler_unittest.cc',
         'section_offset_address_unittest.cc',
         'serialization_unittest.cc',
         'string_table_unittest.cc',
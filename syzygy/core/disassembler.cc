@@ -114,10 +114,8 @@ Disassembler::WalkResult Disassembler::Walk() {
 
       bool conditional_branch_handled = false;
 
-      unsigned int decoded = 0;
-      _DecodeResult result = DistormDecompose(&code, &inst, 1, &decoded);
-
-      if (decoded == 0) {
+      if (!DecodeOneInstruction(addr.value(), code.code, code.codeLen,
+                                &inst)) {
         LOG(ERROR) << "Unable to decode instruction at " << addr << ".";
 
         // Dump the next few bytes. The longest X86 instruction possible is 15
@@ -134,9 +132,6 @@ Disassembler::WalkResult Disassembler::Walk() {
         return kWalkError;
       }
 
-      CHECK_EQ(1U, decoded);
-      CHECK(result == DECRES_MEMORYERR || result == DECRES_SUCCESS);
-
       // Try to visit this instruction.
       VisitedSpace::Range range(addr, inst.size);
       if (!visited_.Insert(range, 0)) {
@@ -16,7 +16,9 @@
 
 #include <algorithm>
 
+#include "base/lazy_instance.h"
 #include "base/logging.h"
+#include "base/macros.h"
 #include "base/strings/stringprintf.h"
 #include "mnemonics.h"  // NOLINT
 
@@ -24,6 +26,13 @@ namespace core {
 
 namespace {
 
+// The fake address that instructions are decoded at when none is provided.
+const uint32_t kDefaultAddress = 0x10000000;
+
+// The number of instructions DecodeInstructionRun decodes into a vector at a
+// time.
+const size_t kRunBatchSize = 64;
+
 // Opcode of the 3-byte VEX instructions.
 const uint8_t kThreeByteVexOpcode = 0xC4;
 
@@ -457,6 +466,410 @@ bool HandleBadDecode(_CodeInfo* ci,
   return true;
 }
 
+// Decodes exactly one instruction with distorm, bypassing the fast path.
+// This is the reference decoding that the fast path reproduces.
+bool DecodeWithDistorm(uint32_t address,
+                       const uint8_t* buffer,
+                       size_t length,
+                       _DInst* instruction) {
+  DCHECK(buffer != NULL);
+  DCHECK(instruction != NULL);
+
+  _CodeInfo code = {};
+  code.dt = Decode32Bits;
+  code.features = DF_NONE;
+  code.codeOffset = address;
+  code.codeLen = static_cast<int>(length);
+  code.code = buffer;
+
+  unsigned int decoded = 0;
+  ::memset(instruction, 0, sizeof(*instruction));
+  _DecodeResult result = DistormDecompose(&code, instruction, 1, &decoded);
+
+  if (result != DECRES_MEMORYERR && result != DECRES_SUCCESS)
+    return false;
+
+  // It's possible for the decode to fail as having decoded a single partially
+  // valid instruction (ie: valid prefix of an instruction, waiting on more
+  // data), in which case it will return MEMORYERR (wants more data) and a
+  // decoded length of zero.
+  if (decoded == 0)
+    return false;
+
+  DCHECK_GE(length, instruction->size);
+  DCHECK_LT(0, instruction->size);
+
+  return true;
+}
+
+// The escape byte introducing the two-byte opcodes.
+const uint8_t kTwoByteOpcodeEscape = 0x0F;
+
+// The longest instruction handled by the fast path: a two-byte opcode, a Mod
+// R/M byte, a 32-bit displacement and a 32-bit immediate.
+const size_t kMaxFastInstructionSize = 11;
+
+// A range of opcodes handled by the fast path. Two-byte opcodes are
+// represented with the 0x0F escape byte as their high byte. None of these
+// take a prefix or a SIB byte, so their length is a function of the opcode and
+// the Mod R/M byte alone.
+struct FastOpcodeRange {
+  uint16_t first;
+  uint16_t last;
+  // True if the opcode is followed by a Mod R/M byte.
+  bool has_modrm;
+  // The size of the immediate, or PC-relative, operand.
+  uint8_t operand_size;
+};
+
+// The opcodes that make up the bulk of compiler generated code.
+const FastOpcodeRange kFastOpcodes[] = {
+    // inc, dec, push and pop of a 32-bit register.
+    { 0x40, 0x5F, false, 0 },
+    // nop, xchg eax, r32, cwde and cdq.
+    { 0x90, 0x99, false, 0 },
+    // ret, leave and int3.
+    { 0xC3, 0xC3, false, 0 },
+    { 0xC9, 0xC9, false, 0 },
+    { 0xCC, 0xCC, false, 0 },
+    // Arithmetic on al with an 8-bit immediate.
+    { 0x04, 0x04, false, 1 },
+    { 0x0C, 0x0C, false, 1 },
+    { 0x24, 0x24, false, 1 },
+    { 0x2C, 0x2C, false, 1 },
+    { 0x34, 0x34, false, 1 },
+    { 0x3C, 0x3C, false, 1 },
+    { 0xA8, 0xA8, false, 1 },
+    // push imm8, jcc rel8, mov r8, imm8, int imm8 and jmp rel8.
+    { 0x6A, 0x6A, false, 1 },
+    { 0x70, 0x7F, false, 1 },
+    { 0xB0, 0xB7, false, 1 },
+    { 0xCD, 0xCD, false, 1 },
+    { 0xEB, 0xEB, false, 1 },
+    // ret imm16.
+    { 0xC2, 0xC2, false, 2 },
+    // Arithmetic on eax with a 32-bit immediate.
+    { 0x05, 0x05, false, 4 },
+    { 0x0D, 0x0D, false, 4 },
+    { 0x25, 0x25, false, 4 },
+    { 0x2D, 0x2D, false, 4 },
+    { 0x35, 0x35, false, 4 },
+    { 0x3D, 0x3D, false, 4 },
+    { 0xA9, 0xA9, false, 4 },
+    // push imm32, mov eax to and from a memory offset, mov r32, imm32, call
+    // rel32, jmp rel32 and jcc rel32.
+    { 0x68, 0x68, false, 4 },
+    { 0xA1, 0xA1, false, 4 },
+    { 0xA3, 0xA3, false, 4 },
+    { 0xB8, 0xBF, false, 4 },
+    { 0xE8, 0xE9, false, 4 },
+    { 0x0F80, 0x0F8F, false, 4 },
+    // Arithmetic between a register and a register or memory operand.
+    { 0x00, 0x03, true, 0 },
+    { 0x08, 0x0B, true, 0 },
+    { 0x20, 0x23, true, 0 },
+    { 0x28, 0x2B, true, 0 },
+    { 0x30, 0x33, true, 0 },
+    { 0x38, 0x3B, true, 0 },
+    // test, mov and lea.
+    { 0x84, 0x85, true, 0 },
+    { 0x88, 0x8B, true, 0 },
+    { 0x8D, 0x8D, true, 0 },
+    // Shifts by one, and the inc/dec/call/jmp/push group.
+    { 0xD1, 0xD1, true, 0 },
+    { 0xFF, 0xFF, true, 0 },
+    // movzx, movsx and imul.
+    { 0x0FAF, 0x0FAF, true, 0 },
+    { 0x0FB6, 0x0FB7, true, 0 },
+    { 0x0FBE, 0x0FBF, true, 0 },
+    // Arithmetic, shifts, mov and imul with an 8-bit immediate.
+    { 0x6B, 0x6B, true, 1 },
+    { 0x80, 0x80, true, 1 },
+    { 0x83, 0x83, true, 1 },
+    { 0xC0, 0xC1, true, 1 },
+    { 0xC6, 0xC6, true, 1 },
+    // Arithmetic, mov and imul with a 32-bit immediate.
+    { 0x69, 0x69, true, 4 },
+    { 0x81, 0x81, true, 4 },
+    { 0xC7, 0xC7, true, 4 },
+};
+
+// The ways in which the bytes of an operand are stored in a decoded
+// instruction.
+enum FastOperandRule {
+  kSignExtendToImm,
+  kZeroExtendToImm,
+  kSignExtendToDisp,
+  kZeroExtendToDisp,
+  kFastOperandRuleCount,
+};
+
+// The decoding of an instruction with its displacement and operand zeroed,
+// along with where those go when decoding an actual instruction.
+struct FastTemplate {
+  _DInst instruction;
+  // The size of the instruction, or zero if the fast path doesn't handle it.
+  uint8_t size;
+  uint8_t disp_offset;
+  uint8_t disp_size;
+  uint8_t disp_rule;
+  uint8_t operand_offset;
+  uint8_t operand_size;
+  uint8_t operand_rule;
+};
+
+// Reads the little-endian value of @p size bytes at @p data.
+uint64_t ReadOperand(const uint8_t* data, size_t size, bool sign_extend) {
+  DCHECK_LT(0u, size);
+  DCHECK_GE(sizeof(uint64_t), size);
+  uint64_t value = 0;
+  for (size_t i = size; i > 0; --i)
+    value = (value << 8) | data[i - 1];
+  if (sign_extend && size < sizeof(value) && (data[size - 1] & 0x80) != 0)
+    value |= ~static_cast<uint64_t>(0) << (size * 8);
+  return value;
+}
+
+// Stores the operand of @p size bytes at @p data in @p instruction according
+// to @p rule.
+void PatchOperand(const uint8_t* data,
+                  size_t size,
+                  uint8_t rule,
+                  _DInst* instruction) {
+  DCHECK_GT(kFastOperandRuleCount, rule);
+  switch (rule) {
+    case kSignExtendToImm:
+    case kZeroExtendToImm:
+      instruction->imm.qword =
+          ReadOperand(data, size, rule == kSignExtendToImm);
+      break;
+    case kSignExtendToDisp:
+    case kZeroExtendToDisp:
+      instruction->disp = ReadOperand(data, size, rule == kSignExtendToDisp);
+      break;
+  }
+}
+
+// Produces the decoding of the instruction at @p data from @p tmpl.
+void InstantiateTemplate(const FastTemplate& tmpl,
+                         uint32_t address,
+                         const uint8_t* data,
+                         _DInst* instruction) {
+  DCHECK_LT(0u, tmpl.size);
+  *instruction = tmpl.instruction;
+  instruction->addr = address;
+  if (tmpl.disp_size != 0) {
+    PatchOperand(data + tmpl.disp_offset, tmpl.disp_size, tmpl.disp_rule,
+                 instruction);
+  }
+  if (tmpl.operand_size != 0) {
+    PatchOperand(data + tmpl.operand_offset, tmpl.operand_size,
+                 tmpl.operand_rule, instruction);
+  }
+}
+
+// The precomputed decodings for the opcodes in kFastOpcodes. Rather than
+// describing how each opcode is decoded, which would have to be kept in sync
+// with distorm and the workarounds in DistormDecompose, the templates are
+// produced by distorm itself, and every template is checked to reproduce the
+// decoding distorm yields for sample operands. Opcodes that fail the check
+// are left to distorm.
+class FastDecodeTable {
+ public:
+  FastDecodeTable();
+
+  // Decodes the instruction at @p buffer if the fast path handles it.
+  // @returns true if @p instruction was decoded, false otherwise.
+  bool Decode(uint32_t address,
+              const uint8_t* buffer,
+              size_t length,
+              _DInst* instruction) const;
+
+ private:
+  // The templates of one opcode: either a single template, or one per Mod R/M
+  // byte value.
+  struct Slot {
+    uint32_t first_template;
+    bool has_modrm;
+  };
+
+  // Lays out, decodes and validates the template of an opcode.
+  // @param opcode the opcode, as found in kFastOpcodes.
+  // @param modrm the Mod R/M byte, if @p has_modrm is true.
+  // @param operand_size the size of the immediate or PC-relative operand.
+  // @param tmpl receives the template. Its size is left at zero if the fast
+  //     path can't handle the instruction.
+  static void BuildTemplate(uint16_t opcode,
+                            bool has_modrm,
+                            uint8_t modrm,
+                            uint8_t operand_size,
+                            FastTemplate* tmpl);
+
+  // Checks that @p tmpl reproduces the decoding of the instruction @p bytes
+  // of @p size bytes, once its displacement and operand are patched in.
+  static bool MatchesDistorm(const FastTemplate& tmpl,
+                             const uint8_t* bytes,
+                             size_t size);
+
+  // Indexed by the escape (0 for one-byte opcodes, 1 for two-byte opcodes)
+  // then the opcode byte. A first_template of 0 means no templates, otherwise
+  // the templates start at first_template - 1.
+  Slot slots_[2][256];
+  std::vector<FastTemplate> templates_;
+
+  DISALLOW_COPY_AND_ASSIGN(FastDecodeTable);
+};
+
+FastDecodeTable::FastDecodeTable() {
+  ::memset(slots_, 0, sizeof(slots_));
+
+  for (size_t i = 0; i < arraysize(kFastOpcodes); ++i) {
+    const FastOpcodeRange& range = kFastOpcodes[i];
+    for (uint32_t opcode = range.first; opcode <= range.last; ++opcode) {
+      Slot& slot = slots_[opcode > 0xFF ? 1 : 0][opcode & 0xFF];
+      DCHECK_EQ(0u, slot.first_template);
+      slot.first_template = static_cast<uint32_t>(templates_.size() + 1);
+      slot.has_modrm = range.has_modrm;
+
+      size_t count = range.has_modrm ? 256 : 1;
+      templates_.resize(templates_.size() + count);
+      FastTemplate* tmpl = &templates_[slot.first_template - 1];
+      for (size_t j = 0; j < count; ++j) {
+        BuildTemplate(static_cast<uint16_t>(opcode), range.has_modrm,
+                      static_cast<uint8_t>(j), range.operand_size,
+                      tmpl + j);
+      }
+    }
+  }
+}
+
+bool FastDecodeTable::Decode(uint32_t address,
+                             const uint8_t* buffer,
+                             size_t length,
+                             _DInst* instruction) const {
+  DCHECK(buffer != NULL);
+  DCHECK(instruction != NULL);
+
+  if (length == 0)
+    return false;
+
+  size_t offset = 1;
+  const Slot* slot = &slots_[0][buffer[0]];
+  if (buffer[0] == kTwoByteOpcodeEscape) {
+    if (length < 2)
+      return false;
+    slot = &slots_[1][buffer[1]];
+    offset = 2;
+  }
+  if (slot->first_template == 0)
+    return false;
+
+  size_t index = slot->first_template - 1;
+  if (slot->has_modrm) {
+    if (length <= offset)
+      return false;
+    index += buffer[offset];
+  }
+
+  const FastTemplate& tmpl = templates_[index];
+  if (tmpl.size == 0 || tmpl.size > length)
+    return false;
+
+  InstantiateTemplate(tmpl, address, buffer, instruction);
+  return true;
+}
+
+void FastDecodeTable::BuildTemplate(uint16_t opcode,
+                                    bool has_modrm,
+                                    uint8_t modrm,
+                                    uint8_t operand_size,
+                                    FastTemplate* tmpl) {
+  DCHECK(tmpl != NULL);
+  ::memset(tmpl, 0, sizeof(*tmpl));
+
+  // Lay out the instruction.
+  uint8_t bytes[kMaxFastInstructionSize] = {};
+  size_t size = 0;
+  if (opcode > 0xFF)
+    bytes[size++] = kTwoByteOpcodeEscape;
+  bytes[size++] = static_cast<uint8_t>(opcode);
+  if (has_modrm) {
+    ModRMByte modrm_byte(modrm);
+    bytes[size++] = modrm;
+    if (modrm_byte.mod != 0x3) {
+      // Instructions with a SIB byte are left to distorm.
+      if (modrm_byte.r_m == 0x4)
+        return;
+      if (modrm_byte.mod == 0x1)
+        tmpl->disp_size = 1;
+      else if (modrm_byte.mod == 0x2 || modrm_byte.r_m == 0x5)
+        tmpl->disp_size = 4;
+    }
+  }
+  tmpl->disp_offset = static_cast<uint8_t>(size);
+  size += tmpl->disp_size;
+  tmpl->operand_offset = static_cast<uint8_t>(size);
+  tmpl->operand_size = operand_size;
+  size += operand_size;
+  DCHECK_GE(kMaxFastInstructionSize, size);
+
+  // Decode the instruction with a zero displacement and operand.
+  if (!DecodeWithDistorm(0, bytes, size, &tmpl->instruction) ||
+      tmpl->instruction.size != size) {
+    return;
+  }
+  tmpl->size = static_cast<uint8_t>(size);
+
+  // Find how the displacement and operand are stored, using samples of
+  // either sign.
+  static const uint8_t kPositiveSample[] = { 0x12, 0x34, 0x56, 0x78 };
+  static const uint8_t kNegativeSample[] = { 0x9A, 0xBC, 0xDE, 0xF1 };
+  uint8_t positive[kMaxFastInstructionSize] = {};
+  uint8_t negative[kMaxFastInstructionSize] = {};
+  ::memcpy(positive, bytes, size);
+  ::memcpy(negative, bytes, size);
+  ::memcpy(positive + tmpl->disp_offset, kPositiveSample, tmpl->disp_size);
+  ::memcpy(negative + tmpl->disp_offset, kNegativeSample, tmpl->disp_size);
+  ::memcpy(positive + tmpl->operand_offset, kPositiveSample, operand_size);
+  ::memcpy(negative + tmpl->operand_offset, kNegativeSample, operand_size);
+
+  for (uint8_t disp_rule = 0; disp_rule < kFastOperandRuleCount; ++disp_rule) {
+    for (uint8_t operand_rule = 0; operand_rule < kFastOperandRuleCount;
+         ++operand_rule) {
+      tmpl->disp_rule = disp_rule;
+      tmpl->operand_rule = operand_rule;
+      if (MatchesDistorm(*tmpl, positive, size) &&
+          MatchesDistorm(*tmpl, negative, size)) {
+        return;
+      }
+    }
+  }
+
+  // The decoding depends on the operands in a way the fast path can't
+  // reproduce.
+  tmpl->size = 0;
+}
+
+bool FastDecodeTable::MatchesDistorm(const FastTemplate& tmpl,
+                                     const uint8_t* bytes,
+                                     size_t size) {
+  DCHECK(bytes != NULL);
+
+  // Decode at an address other than that of the template, to catch decodings
+  // that depend on it.
+  _DInst expected = {};
+  if (!DecodeWithDistorm(kDefaultAddress, bytes, size, &expected))
+    return false;
+
+  _DInst actual = {};
+  InstantiateTemplate(tmpl, kDefaultAddress, bytes, &actual);
+  return ::memcmp(&expected, &actual, sizeof(expected)) == 0;
+}
+
+// The fast path tables are built on first use.
+base::LazyInstance<FastDecodeTable>::Leaky fast_decode_table =
+    LAZY_INSTANCE_INITIALIZER;
+
 }  // namespace
 
 _DecodeResult DistormDecompose(_CodeInfo* ci,
@@ -512,31 +925,10 @@ bool DecodeOneInstruction(uint32_t address,
   DCHECK(buffer != NULL);
   DCHECK(instruction != NULL);
 
-  _CodeInfo code = {};
-  code.dt = Decode32Bits;
-  code.features = DF_NONE;
-  code.codeOffset = address;
-  code.codeLen = static_cast<int>(length);
-  code.code = buffer;
-
-  unsigned int decoded = 0;
-  ::memset(instruction, 0, sizeof(*instruction));
-  _DecodeResult result = DistormDecompose(&code, instruction, 1, &decoded);
-
-  if (result != DECRES_MEMORYERR && result != DECRES_SUCCESS)
-    return false;
-
-  // It's possible for the decode to fail as having decoded a single partially
-  // valid instruction (ie: valid prefix of an instruction, waiting on more
-  // data), in which case it will return MEMORYERR (wants more data) and a
-  // decoded length of zero.
-  if (decoded == 0)
-    return false;
-
-  DCHECK_GE(length, instruction->size);
-  DCHECK_LT(0, instruction->size);
+  if (fast_decode_table.Get().Decode(address, buffer, length, instruction))
+    return true;
 
-  return true;
+  return DecodeWithDistorm(address, buffer, length, instruction);
 }
 
 bool DecodeOneInstruction(const uint8_t* buffer,
@@ -544,11 +936,74 @@ bool DecodeOneInstruction(const uint8_t* buffer,
                           _DInst* instruction) {
   DCHECK(buffer != NULL);
   DCHECK(instruction != NULL);
-  if (!DecodeOneInstruction(0x10000000, buffer, length, instruction))
+  if (!DecodeOneInstruction(kDefaultAddress, buffer, length, instruction))
     return false;
   return true;
 }
 
+size_t DecodeInstructionRun(uint32_t address,
+                            const uint8_t* buffer,
+                            size_t length,
+                            _DInst* instructions,
+                            size_t max_instructions,
+                            size_t* instruction_count) {
+  DCHECK(buffer != NULL);
+  DCHECK(instructions != NULL || max_instructions == 0);
+  DCHECK(instruction_count != NULL);
+
+  const FastDecodeTable& table = fast_decode_table.Get();
+  size_t offset = 0;
+  size_t count = 0;
+  while (offset < length && count < max_instructions) {
+    const uint8_t* data = buffer + offset;
+    size_t remaining = length - offset;
+    uint32_t instruction_address = address + static_cast<uint32_t>(offset);
+    _DInst* instruction = &instructions[count];
+    if (!table.Decode(instruction_address, data, remaining, instruction) &&
+        !DecodeWithDistorm(instruction_address, data, remaining,
+                           instruction)) {
+      break;
+    }
+    offset += instruction->size;
+    ++count;
+  }
+
+  DCHECK_GE(length, offset);
+  *instruction_count = count;
+  return offset;
+}
+
+size_t DecodeInstructionRun(const uint8_t* buffer,
+                            size_t length,
+                            std::vector<_DInst>* instructions) {
+  DCHECK(buffer != NULL);
+  DCHECK(instructions != NULL);
+
+  size_t offset = 0;
+  while (offset < length) {
+    size_t first = instructions->size();
+    instructions->resize(first + kRunBatchSize);
+
+    // Each instruction is given the address it would have been decoded at on
+    // its own.
+    size_t count = 0;
+    offset += DecodeInstructionRun(kDefaultAddress, buffer + offset,
+                                   length - offset, &(*instructions)[first],
+                                   kRunBatchSize, &count);
+    instructions->resize(first + count);
+    for (size_t i = first; i < instructions->size(); ++i)
+      (*instructions)[i].addr = kDefaultAddress;
+
+    // A short batch means the run ended on an instruction that can't be
+    // decoded.
+    if (count < kRunBatchSize)
+      break;
+  }
+
+  DCHECK_GE(length, offset);
+  return offset;
+}
+
 bool InstructionToString(
     const _DInst& instruction,
     const uint8_t* data,
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "syzygy/assm/register.h"
 #include "distorm.h"  // NOLINT
@@ -47,7 +48,10 @@ _DecodeResult DistormDecompose(_CodeInfo* ci,
                                unsigned int max_instructions,
                                unsigned int* used_instructions_count);
 
-// Decodes exactly one instruction from the given buffer.
+// Decodes exactly one instruction from the given buffer. The common
+// instructions of compiler generated code are decoded from precomputed
+// tables, and the rest by distorm via DistormDecompose; either way the
+// result is the one distorm yields.
 // @param address the address of the instruction, as an absolute address
 //     consistent with the image's base address. If this is not provided a
 //     fake address of 0x10000000 will be used.
@@ -62,6 +66,38 @@ bool DecodeOneInstruction(const uint8_t* buffer,
                           size_t length,
                           _DInst* instruction);
 
+// Decodes a linear run of instructions from the given buffer into a
+// preallocated array, stopping at the end of the buffer, at the first
+// instruction that can't be decoded or once the array is full. The decoded
+// instructions are identical to those repeated calls to DecodeOneInstruction
+// would yield.
+// @param address the address of the first instruction. Each instruction is
+//     given its own address.
+// @param buffer the buffer containing the data to decode.
+// @param length the length of the buffer.
+// @param instructions the array receiving the decoded instructions.
+// @param max_instructions the number of entries in @p instructions.
+// @param instruction_count receives the number of decoded instructions.
+// @returns the number of bytes covered by the decoded instructions.
+size_t DecodeInstructionRun(uint32_t address,
+                            const uint8_t* buffer,
+                            size_t length,
+                            _DInst* instructions,
+                            size_t max_instructions,
+                            size_t* instruction_count);
+
+// Decodes a linear run of instructions from the given buffer, stopping at the
+// end of the buffer or at the first instruction that can't be decoded. The
+// decoded instructions are identical to those repeated calls to
+// DecodeOneInstruction without an address would yield.
+// @param buffer the buffer containing the data to decode.
+// @param length the length of the buffer.
+// @param instructions receives the decoded instructions.
+// @returns the number of bytes covered by the decoded instructions.
+size_t DecodeInstructionRun(const uint8_t* buffer,
+                            size_t length,
+                            std::vector<_DInst>* instructions);
+
 // Dump text representation of exactly one instruction to a std::string.
 // @param instruction the instruction to dump.
 // @param data points to the raw byte sequences.
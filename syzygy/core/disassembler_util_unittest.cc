@@ -403,4 +403,132 @@ TEST(DisassemblerUtilTest, TestBadlyDecodedCRC32) {
       TestBadlyDecodedInstruction(kCrc32CX, sizeof(kCrc32CX)));
 }
 
+TEST(DisassemblerUtilTest, DecodeInstructionRun) {
+  // A run longer than a single batch of the decoder, which mixes instructions
+  // that need the decoder workarounds with regular ones, and ends with a
+  // truncated instruction.
+  std::vector<uint8_t> buffer;
+  for (size_t i = 0; i < 100; ++i) {
+    buffer.insert(buffer.end(), kCall, kCall + sizeof(kCall));
+    buffer.insert(buffer.end(), kVxorps, kVxorps + sizeof(kVxorps));
+    buffer.insert(buffer.end(), kCrc32CX, kCrc32CX + sizeof(kCrc32CX));
+    buffer.insert(buffer.end(), kStmxcsr, kStmxcsr + sizeof(kStmxcsr));
+    buffer.insert(buffer.end(), kNop3Lea, kNop3Lea + sizeof(kNop3Lea));
+  }
+  buffer.insert(buffer.end(), kRet, kRet + sizeof(kRet));
+  size_t decodable_length = buffer.size();
+  buffer.insert(buffer.end(), kCall, kCall + sizeof(kCall) - 1);
+
+  std::vector<_DInst> instructions;
+  EXPECT_EQ(decodable_length, DecodeInstructionRun(buffer.data(),
+                                                   buffer.size(),
+                                                   &instructions));
+
+  // The run matches the instructions decoded one at a time.
+  size_t offset = 0;
+  for (const _DInst& instruction : instructions) {
+    _DInst expected = {};
+    ASSERT_TRUE(DecodeOneInstruction(buffer.data() + offset,
+                                     buffer.size() - offset,
+                                     &expected));
+    EXPECT_EQ(0, ::memcmp(&expected, &instruction, sizeof(expected)));
+    offset += instruction.size;
+  }
+  EXPECT_EQ(decodable_length, offset);
+  EXPECT_EQ(501u, instructions.size());
+
+  // An empty buffer yields an empty run.
+  instructions.clear();
+  EXPECT_EQ(0u, DecodeInstructionRun(buffer.data(), 0, &instructions));
+  EXPECT_TRUE(instructions.empty());
+}
+
+TEST(DisassemblerUtilTest, DecodeOneInstructionMatchesDistorm) {
+  // Every one- and two-byte opcode, including the two-byte escape, followed
+  // by operand bytes of either sign, decodes as distorm decodes it.
+  static const uint8_t kTails[][8] = {
+      { 0x45, 0x7C, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 },
+      { 0x85, 0xF0, 0xFF, 0xFF, 0x80, 0x90, 0xA0, 0xB0 },
+  };
+  const uint32_t kAddress = 0x00401000;
+  for (size_t escape = 0; escape < 2; ++escape) {
+    for (size_t tail = 0; tail < arraysize(kTails); ++tail) {
+      for (uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+        uint8_t buffer[11] = {};
+        size_t size = 0;
+        if (escape)
+          buffer[size++] = 0x0F;
+        buffer[size++] = static_cast<uint8_t>(opcode >> 8);
+        buffer[size++] = static_cast<uint8_t>(opcode);
+        ::memcpy(buffer + size, kTails[tail], sizeof(kTails[tail]));
+        size += sizeof(kTails[tail]);
+
+        _CodeInfo code = {};
+        code.dt = Decode32Bits;
+        code.features = DF_NONE;
+        code.codeOffset = kAddress;
+        code.codeLen = static_cast<int>(size);
+        code.code = buffer;
+        _DInst expected = {};
+        unsigned int decoded = 0;
+        _DecodeResult result = DistormDecompose(&code, &expected, 1, &decoded);
+        bool expected_ok =
+            (result == DECRES_SUCCESS || result == DECRES_MEMORYERR) &&
+            decoded == 1;
+
+        _DInst actual = {};
+        ASSERT_EQ(expected_ok,
+                  DecodeOneInstruction(kAddress, buffer, size, &actual));
+        if (expected_ok)
+          ASSERT_EQ(0, ::memcmp(&expected, &actual, sizeof(expected)));
+      }
+    }
+  }
+}
+
+TEST(DisassemblerUtilTest, DecodeInstructionRunIntoArray) {
+  std::vector<uint8_t> buffer;
+  for (size_t i = 0; i < 10; ++i) {
+    buffer.insert(buffer.end(), kCall, kCall + sizeof(kCall));
+    buffer.insert(buffer.end(), kVxorps, kVxorps + sizeof(kVxorps));
+    buffer.insert(buffer.end(), kNop3Lea, kNop3Lea + sizeof(kNop3Lea));
+  }
+  buffer.insert(buffer.end(), kRet, kRet + sizeof(kRet));
+  size_t decodable_length = buffer.size();
+  buffer.insert(buffer.end(), kCall, kCall + sizeof(kCall) - 1);
+
+  // Each instruction is decoded at its own address.
+  const uint32_t kAddress = 0x00401000;
+  _DInst instructions[64] = {};
+  size_t count = 0;
+  EXPECT_EQ(decodable_length,
+            DecodeInstructionRun(kAddress, buffer.data(), buffer.size(),
+                                 instructions, arraysize(instructions),
+                                 &count));
+  EXPECT_EQ(31u, count);
+  size_t offset = 0;
+  for (size_t i = 0; i < count; ++i) {
+    _DInst expected = {};
+    ASSERT_TRUE(DecodeOneInstruction(kAddress + offset,
+                                     buffer.data() + offset,
+                                     buffer.size() - offset,
+                                     &expected));
+    EXPECT_EQ(0, ::memcmp(&expected, &instructions[i], sizeof(expected)));
+    offset += instructions[i].size;
+  }
+
+  // The run stops once the array is full.
+  count = 0;
+  EXPECT_EQ(sizeof(kCall) + sizeof(kVxorps),
+            DecodeInstructionRun(kAddress, buffer.data(), buffer.size(),
+                                 instructions, 2, &count));
+  EXPECT_EQ(2u, count);
+
+  // An empty buffer yields an empty run.
+  EXPECT_EQ(0u, DecodeInstructionRun(kAddress, buffer.data(), 0,
+                                     instructions, arraysize(instructions),
+                                     &count));
+  EXPECT_EQ(0u, count);
+}
+
 }  // namespace core
@@ -0,0 +1,232 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/phase_profiler.h"
+
+#include <windows.h>  // NOLINT
+#include <psapi.h>
+
+#include "base/atomicops.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "syzygy/core/json_file_writer.h"
+
+namespace core {
+
+namespace {
+
+// The profiler in effect.
+base::subtle::AtomicWord current_profiler = 0;
+
+// The keys of the JSON phase dictionaries.
+const char kNameKey[] = "name";
+const char kWallTimeKey[] = "wall_time";
+const char kCpuTimeKey[] = "cpu_time";
+const char kPeakWorkingSetKey[] = "peak_working_set_kb";
+const char kBlocksKey[] = "blocks";
+const char kReferencesKey[] = "references";
+const char kPhasesKey[] = "phases";
+
+uint64_t FileTimeToUint64(const FILETIME& file_time) {
+  return (static_cast<uint64_t>(file_time.dwHighDateTime) << 32) |
+      file_time.dwLowDateTime;
+}
+
+}  // namespace
+
+const size_t PhaseProfiler::kNoParent = static_cast<size_t>(-1);
+
+PhaseProfiler::Phase::Phase()
+    : parent(kNoParent),
+      peak_working_set(0),
+      has_counts(false),
+      block_count(0),
+      reference_count(0) {
+}
+
+PhaseProfiler::ScopedPhase::ScopedPhase(PhaseProfiler* profiler,
+                                        const base::StringPiece& name)
+    : profiler_(profiler), index_(0) {
+  if (profiler_ == NULL)
+    return;
+  index_ = profiler_->BeginPhase(name);
+  start_cpu_time_ = GetProcessCpuTime();
+  start_time_ = base::TimeTicks::Now();
+}
+
+PhaseProfiler::ScopedPhase::~ScopedPhase() {
+  if (profiler_ == NULL)
+    return;
+  base::TimeDelta wall_time = base::TimeTicks::Now() - start_time_;
+  base::TimeDelta cpu_time = GetProcessCpuTime() - start_cpu_time_;
+  profiler_->EndPhase(index_, wall_time, cpu_time);
+}
+
+void PhaseProfiler::ScopedPhase::SetCounts(size_t block_count,
+                                           size_t reference_count) {
+  if (profiler_ == NULL)
+    return;
+  Phase& phase = profiler_->phases_[index_];
+  phase.has_counts = true;
+  phase.block_count = block_count;
+  phase.reference_count = reference_count;
+}
+
+PhaseProfiler::ScopedCurrent::ScopedCurrent(PhaseProfiler* profiler)
+    : previous_(current()) {
+  DCHECK(profiler != NULL);
+  base::subtle::Release_Store(
+      &current_profiler, reinterpret_cast<base::subtle::AtomicWord>(profiler));
+}
+
+PhaseProfiler::ScopedCurrent::~ScopedCurrent() {
+  base::subtle::Release_Store(
+      &current_profiler,
+      reinterpret_cast<base::subtle::AtomicWord>(previous_));
+}
+
+PhaseProfiler::PhaseProfiler() {
+}
+
+PhaseProfiler::~PhaseProfiler() {
+  DCHECK(open_phases_.empty());
+  DCHECK_NE(this, current());
+}
+
+PhaseProfiler* PhaseProfiler::current() {
+  return reinterpret_cast<PhaseProfiler*>(
+      base::subtle::Acquire_Load(&current_profiler));
+}
+
+bool PhaseProfiler::SaveToJSON(JSONFileWriter* json_file) const {
+  DCHECK(json_file != NULL);
+
+  if (!json_file->OpenList())
+    return false;
+  for (size_t i = 0; i < phases_.size(); ++i) {
+    if (phases_[i].parent == kNoParent && !SavePhaseToJSON(i, json_file))
+      return false;
+  }
+  return json_file->CloseList() && json_file->Flush();
+}
+
+bool PhaseProfiler::SaveToJSON(const base::FilePath& path,
+                               bool pretty_print) const {
+  base::ScopedFILE file(base::OpenFile(path, "wb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to create phase profile: " << path.value();
+    return false;
+  }
+
+  JSONFileWriter json_file(file.get(), pretty_print);
+  if (!SaveToJSON(&json_file)) {
+    LOG(ERROR) << "Unable to write phase profile: " << path.value();
+    return false;
+  }
+
+  return true;
+}
+
+base::TimeDelta PhaseProfiler::GetProcessCpuTime() {
+  FILETIME creation_time = {};
+  FILETIME exit_time = {};
+  FILETIME kernel_time = {};
+  FILETIME user_time = {};
+  if (!::GetProcessTimes(::GetCurrentProcess(), &creation_time, &exit_time,
+                         &kernel_time, &user_time)) {
+    return base::TimeDelta();
+  }
+
+  // The times are in units of 100ns.
+  uint64_t time = FileTimeToUint64(kernel_time) + FileTimeToUint64(user_time);
+  return base::TimeDelta::FromMicroseconds(static_cast<int64_t>(time / 10));
+}
+
+uint64_t PhaseProfiler::GetPeakWorkingSet() {
+  PROCESS_MEMORY_COUNTERS counters = {};
+  if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters,
+                              sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+}
+
+size_t PhaseProfiler::BeginPhase(const base::StringPiece& name) {
+  size_t index = phases_.size();
+  phases_.push_back(Phase());
+  Phase& phase = phases_.back();
+  name.CopyToString(&phase.name);
+  if (!open_phases_.empty()) {
+    phase.parent = open_phases_.back();
+    phases_[phase.parent].children.push_back(index);
+  }
+  open_phases_.push_back(index);
+  return index;
+}
+
+void PhaseProfiler::EndPhase(size_t index,
+                             base::TimeDelta wall_time,
+                             base::TimeDelta cpu_time) {
+  DCHECK(!open_phases_.empty());
+  DCHECK_EQ(open_phases_.back(), index);
+  open_phases_.pop_back();
+
+  Phase& phase = phases_[index];
+  phase.wall_time = wall_time;
+  phase.cpu_time = cpu_time;
+  phase.peak_working_set = GetPeakWorkingSet();
+}
+
+bool PhaseProfiler::SavePhaseToJSON(size_t index,
+                                    JSONFileWriter* json_file) const {
+  DCHECK(json_file != NULL);
+  const Phase& phase = phases_[index];
+
+  if (!json_file->OpenDict() ||
+      !json_file->OutputKey(kNameKey) ||
+      !json_file->OutputString(phase.name) ||
+      !json_file->OutputKey(kWallTimeKey) ||
+      !json_file->OutputDouble(phase.wall_time.InSecondsF()) ||
+      !json_file->OutputKey(kCpuTimeKey) ||
+      !json_file->OutputDouble(phase.cpu_time.InSecondsF()) ||
+      !json_file->OutputKey(kPeakWorkingSetKey) ||
+      !json_file->OutputInteger(
+          static_cast<int>(phase.peak_working_set / 1024))) {
+    return false;
+  }
+
+  if (phase.has_counts) {
+    if (!json_file->OutputKey(kBlocksKey) ||
+        !json_file->OutputInteger(static_cast<int>(phase.block_count)) ||
+        !json_file->OutputKey(kReferencesKey) ||
+        !json_file->OutputInteger(static_cast<int>(phase.reference_count))) {
+      return false;
+    }
+  }
+
+  if (!phase.children.empty()) {
+    if (!json_file->OutputKey(kPhasesKey) || !json_file->OpenList())
+      return false;
+    for (size_t child : phase.children) {
+      if (!SavePhaseToJSON(child, json_file))
+        return false;
+    }
+    if (!json_file->CloseList())
+      return false;
+  }
+
+  return json_file->CloseDict();
+}
+
+}  // namespace core
@@ -0,0 +1,177 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a profiler of the phases of a long-running operation, such as a
+// relink. Phases are delimited by ScopedPhase objects and may nest; each
+// records its wall and CPU time, the peak working set of the process at its
+// end, and optionally the size of the block graph it left behind. The
+// profile can be written out as JSON.
+//
+// Like the decoded instruction cache, the profiler in effect is process-wide
+// so that the code deep down a relink can report its phases without the
+// profiler being passed around:
+//
+// @code
+//   core::PhaseProfiler profiler;
+//   core::PhaseProfiler::ScopedCurrent scoped_profiler(&profiler);
+//   ...
+//   {
+//     core::PhaseProfiler::ScopedPhase phase(
+//         core::PhaseProfiler::current(), "decompose");
+//     ...
+//   }
+//   profiler.SaveToJSON(path, true);
+// @endcode
+
+#ifndef SYZYGY_CORE_PHASE_PROFILER_H_
+#define SYZYGY_CORE_PHASE_PROFILER_H_
+
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "base/strings/string_piece.h"
+#include "base/time/time.h"
+
+namespace core {
+
+// Forward declaration.
+class JSONFileWriter;
+
+class PhaseProfiler {
+ public:
+  // The index of the parent of a top-level phase.
+  static const size_t kNoParent;
+
+  // A phase, as recorded once it has ended.
+  struct Phase {
+    Phase();
+
+    std::string name;
+    // The index of the enclosing phase, or kNoParent.
+    size_t parent;
+    // The indices of the phases nested in this one, in order.
+    std::vector<size_t> children;
+    // The time the phase took.
+    base::TimeDelta wall_time;
+    // The CPU time spent by the process, on all threads, during the phase.
+    base::TimeDelta cpu_time;
+    // The peak working set of the process at the end of the phase, in bytes.
+    // This is a high-water mark since the start of the process.
+    uint64_t peak_working_set;
+    // Whether the counts below were provided.
+    bool has_counts;
+    // The number of blocks and references in the block graph at the end of
+    // the phase.
+    size_t block_count;
+    size_t reference_count;
+  };
+  typedef std::vector<Phase> PhaseVector;
+
+  // Delimits a phase. Phases have to be ended in the reverse order they're
+  // started in.
+  class ScopedPhase {
+   public:
+    // Starts a phase.
+    // @param profiler The profiler to record the phase with. If this is NULL
+    //     nothing is recorded.
+    // @param name The name of the phase.
+    ScopedPhase(PhaseProfiler* profiler, const base::StringPiece& name);
+
+    // Ends the phase.
+    ~ScopedPhase();
+
+    // @returns true if the phase is being recorded.
+    bool enabled() const { return profiler_ != NULL; }
+
+    // Sets the size of the block graph at the end of the phase.
+    // @param block_count The number of blocks.
+    // @param reference_count The number of references.
+    void SetCounts(size_t block_count, size_t reference_count);
+
+   private:
+    PhaseProfiler* profiler_;
+    size_t index_;
+    base::TimeTicks start_time_;
+    base::TimeDelta start_cpu_time_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedPhase);
+  };
+
+  // Makes a profiler current for the lifetime of this object, restoring the
+  // previous one afterwards.
+  class ScopedCurrent {
+   public:
+    explicit ScopedCurrent(PhaseProfiler* profiler);
+    ~ScopedCurrent();
+
+   private:
+    PhaseProfiler* previous_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedCurrent);
+  };
+
+  PhaseProfiler();
+  ~PhaseProfiler();
+
+  // @returns the profiler in effect, or NULL if there's none.
+  static PhaseProfiler* current();
+
+  // @returns the phases recorded so far, in the order they started. A phase
+  //     is only complete once it has ended.
+  const PhaseVector& phases() const { return phases_; }
+
+  // Writes the profile as JSON. This is a list of the top-level phases, each
+  // a dictionary with a list of its nested phases.
+  // @param json_file The writer to use.
+  // @returns true on success, false otherwise.
+  bool SaveToJSON(JSONFileWriter* json_file) const;
+
+  // Writes the profile as JSON to a file.
+  // @param path The path of the file.
+  // @param pretty_print Whether to pretty-print the JSON.
+  // @returns true on success, false otherwise.
+  bool SaveToJSON(const base::FilePath& path, bool pretty_print) const;
+
+  // @returns the CPU time spent by the process so far, on all threads.
+  static base::TimeDelta GetProcessCpuTime();
+
+  // @returns the peak working set of the process so far, in bytes.
+  static uint64_t GetPeakWorkingSet();
+
+ private:
+  // Records the start of a phase.
+  // @returns the index of the phase.
+  size_t BeginPhase(const base::StringPiece& name);
+
+  // Records the end of the innermost phase.
+  void EndPhase(size_t index,
+                base::TimeDelta wall_time,
+                base::TimeDelta cpu_time);
+
+  // Writes a phase and its nested phases.
+  bool SavePhaseToJSON(size_t index, JSONFileWriter* json_file) const;
+
+  PhaseVector phases_;
+
+  // The indices of the phases that have started but not ended.
+  std::vector<size_t> open_phases_;
+
+  DISALLOW_COPY_AND_ASSIGN(PhaseProfiler);
+};
+
+}  // namespace core
+
+#endif  // SYZYGY_CORE_PHASE_PROFILER_H_
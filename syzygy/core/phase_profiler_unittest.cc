@@ -0,0 +1,151 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/core/phase_profiler.h"
+
+#include <memory>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/json/json_reader.h"
+#include "base/values.h"
+#include "gtest/gtest.h"
+
+namespace core {
+
+namespace {
+
+typedef PhaseProfiler::Phase Phase;
+typedef PhaseProfiler::ScopedPhase ScopedPhase;
+
+}  // namespace
+
+TEST(PhaseProfilerTest, NullProfilerRecordsNothing) {
+  ScopedPhase phase(NULL, "phase");
+  EXPECT_FALSE(phase.enabled());
+  phase.SetCounts(1, 2);
+}
+
+TEST(PhaseProfilerTest, NestedPhases) {
+  PhaseProfiler profiler;
+  {
+    ScopedPhase outer(&profiler, "outer");
+    EXPECT_TRUE(outer.enabled());
+    {
+      ScopedPhase inner1(&profiler, "inner1");
+      inner1.SetCounts(10, 20);
+    }
+    {
+      ScopedPhase inner2(&profiler, "inner2");
+    }
+  }
+  {
+    ScopedPhase other(&profiler, "other");
+  }
+
+  const PhaseProfiler::PhaseVector& phases = profiler.phases();
+  ASSERT_EQ(4u, phases.size());
+
+  EXPECT_EQ("outer", phases[0].name);
+  EXPECT_EQ(PhaseProfiler::kNoParent, phases[0].parent);
+  ASSERT_EQ(2u, phases[0].children.size());
+  EXPECT_EQ(1u, phases[0].children[0]);
+  EXPECT_EQ(2u, phases[0].children[1]);
+  EXPECT_FALSE(phases[0].has_counts);
+  EXPECT_LT(0u, phases[0].peak_working_set);
+
+  EXPECT_EQ("inner1", phases[1].name);
+  EXPECT_EQ(0u, phases[1].parent);
+  EXPECT_TRUE(phases[1].has_counts);
+  EXPECT_EQ(10u, phases[1].block_count);
+  EXPECT_EQ(20u, phases[1].reference_count);
+
+  EXPECT_EQ("inner2", phases[2].name);
+  EXPECT_EQ(0u, phases[2].parent);
+
+  EXPECT_EQ("other", phases[3].name);
+  EXPECT_EQ(PhaseProfiler::kNoParent, phases[3].parent);
+  EXPECT_TRUE(phases[3].children.empty());
+
+  // A phase lasts at least as long as the phases nested in it.
+  EXPECT_LE(phases[1].wall_time + phases[2].wall_time, phases[0].wall_time);
+}
+
+TEST(PhaseProfilerTest, ScopedCurrent) {
+  EXPECT_TRUE(PhaseProfiler::current() == NULL);
+  PhaseProfiler profiler1;
+  PhaseProfiler profiler2;
+  {
+    PhaseProfiler::ScopedCurrent scoped_current1(&profiler1);
+    EXPECT_EQ(&profiler1, PhaseProfiler::current());
+    {
+      PhaseProfiler::ScopedCurrent scoped_current2(&profiler2);
+      EXPECT_EQ(&profiler2, PhaseProfiler::current());
+    }
+    EXPECT_EQ(&profiler1, PhaseProfiler::current());
+  }
+  EXPECT_TRUE(PhaseProfiler::current() == NULL);
+}
+
+TEST(PhaseProfilerTest, SaveToJSON) {
+  PhaseProfiler profiler;
+  {
+    ScopedPhase outer(&profiler, "outer");
+    ScopedPhase inner(&profiler, "inner");
+    inner.SetCounts(3, 4);
+  }
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath path = temp_dir.path().AppendASCII("profile.json");
+  ASSERT_TRUE(profiler.SaveToJSON(path, true));
+
+  std::string json;
+  ASSERT_TRUE(base::ReadFileToString(path, &json));
+  std::unique_ptr<base::Value> value(base::JSONReader::Read(json).release());
+  ASSERT_TRUE(value.get() != NULL);
+
+  const base::ListValue* phases = NULL;
+  ASSERT_TRUE(value->GetAsList(&phases));
+  ASSERT_EQ(1u, phases->GetSize());
+
+  const base::DictionaryValue* outer = NULL;
+  ASSERT_TRUE(phases->GetDictionary(0, &outer));
+  std::string name;
+  EXPECT_TRUE(outer->GetString("name", &name));
+  EXPECT_EQ("outer", name);
+  double time = 0;
+  EXPECT_TRUE(outer->GetDouble("wall_time", &time));
+  EXPECT_TRUE(outer->GetDouble("cpu_time", &time));
+  int peak_working_set = 0;
+  EXPECT_TRUE(outer->GetInteger("peak_working_set_kb", &peak_working_set));
+  EXPECT_LT(0, peak_working_set);
+  EXPECT_FALSE(outer->HasKey("blocks"));
+
+  const base::ListValue* nested_phases = NULL;
+  ASSERT_TRUE(outer->GetList("phases", &nested_phases));
+  ASSERT_EQ(1u, nested_phases->GetSize());
+  const base::DictionaryValue* inner = NULL;
+  ASSERT_TRUE(nested_phases->GetDictionary(0, &inner));
+  EXPECT_TRUE(inner->GetString("name", &name));
+  EXPECT_EQ("inner", name);
+  int count = 0;
+  EXPECT_TRUE(inner->GetInteger("blocks", &count));
+  EXPECT_EQ(3, count);
+  EXPECT_TRUE(inner->GetInteger("references", &count));
+  EXPECT_EQ(4, count);
+  EXPECT_FALSE(inner->HasKey("phases"));
+}
+
+}  // namespace core
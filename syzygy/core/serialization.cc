@@ -17,6 +17,7 @@
 #include <windows.h>  // NOLINT
 #include <dbghelp.h>
 #include <stdio.h>
+#include <string.h>
 #include <algorithm>
 
 #include "base/time/time.h"
@@ -56,6 +57,121 @@ bool FileInStream::ReadImpl(size_t length, Byte* bytes, size_t* bytes_read) {
   return true;
 }
 
+ByteVectorOutStream::ByteVectorOutStream(ByteVector* bytes) : bytes_(bytes) {
+  DCHECK(bytes != NULL);
+}
+
+bool ByteVectorOutStream::Write(size_t length, const Byte* bytes) {
+  DCHECK(bytes != NULL || length == 0);
+  bytes_->insert(bytes_->end(), bytes, bytes + length);
+  return true;
+}
+
+BufferedOutStream::BufferedOutStream(OutStream* out_stream)
+    : out_stream_(out_stream), buffer_size_(kDefaultBufferSize) {
+  DCHECK(out_stream != NULL);
+  buffer_.reserve(buffer_size_);
+}
+
+BufferedOutStream::BufferedOutStream(OutStream* out_stream,
+                                     size_t buffer_size)
+    : out_stream_(out_stream), buffer_size_(buffer_size) {
+  DCHECK(out_stream != NULL);
+  DCHECK_LT(0U, buffer_size);
+  buffer_.reserve(buffer_size_);
+}
+
+BufferedOutStream::~BufferedOutStream() {
+  if (!WriteBuffer())
+    LOG(ERROR) << "Unable to write buffered data.";
+}
+
+bool BufferedOutStream::Write(size_t length, const Byte* bytes) {
+  DCHECK(bytes != NULL || length == 0);
+
+  if (buffer_.size() + length > buffer_size_) {
+    if (!WriteBuffer())
+      return false;
+    // Writes that wouldn't fit in the buffer go straight through.
+    if (length >= buffer_size_)
+      return out_stream_->Write(length, bytes);
+  }
+
+  buffer_.insert(buffer_.end(), bytes, bytes + length);
+  return true;
+}
+
+bool BufferedOutStream::Flush() {
+  if (!WriteBuffer())
+    return false;
+  return out_stream_->Flush();
+}
+
+bool BufferedOutStream::WriteBuffer() {
+  if (buffer_.empty())
+    return true;
+  bool result = out_stream_->Write(buffer_.size(), buffer_.data());
+  buffer_.clear();
+  return result;
+}
+
+BufferedInStream::BufferedInStream(InStream* in_stream)
+    : in_stream_(in_stream), buffer_(kDefaultBufferSize), buffer_begin_(0),
+      buffer_end_(0), at_end_(false) {
+  DCHECK(in_stream != NULL);
+}
+
+BufferedInStream::BufferedInStream(InStream* in_stream, size_t buffer_size)
+    : in_stream_(in_stream), buffer_(buffer_size), buffer_begin_(0),
+      buffer_end_(0), at_end_(false) {
+  DCHECK(in_stream != NULL);
+  DCHECK_LT(0U, buffer_size);
+}
+
+bool BufferedInStream::ReadImpl(size_t length,
+                                Byte* bytes,
+                                size_t* bytes_read) {
+  DCHECK(bytes != NULL || length == 0);
+  DCHECK(bytes_read != NULL);
+
+  *bytes_read = 0;
+  while (*bytes_read < length) {
+    // Serve what we can from the buffer.
+    size_t count = std::min(length - *bytes_read, buffer_end_ - buffer_begin_);
+    if (count != 0) {
+      ::memcpy(bytes + *bytes_read, buffer_.data() + buffer_begin_, count);
+      buffer_begin_ += count;
+      *bytes_read += count;
+      continue;
+    }
+
+    if (at_end_)
+      break;
+
+    // Reads that wouldn't fit in the buffer go straight through.
+    size_t remaining = length - *bytes_read;
+    if (remaining >= buffer_.size()) {
+      size_t direct_read = 0;
+      if (!in_stream_->Read(remaining, bytes + *bytes_read, &direct_read))
+        return false;
+      *bytes_read += direct_read;
+      at_end_ = direct_read != remaining;
+      break;
+    }
+
+    // Otherwise refill the buffer. A short read means the stream is
+    // exhausted.
+    size_t buffer_read = 0;
+    if (!in_stream_->Read(buffer_.size(), buffer_.data(), &buffer_read))
+      return false;
+    buffer_begin_ = 0;
+    buffer_end_ = buffer_read;
+    at_end_ = buffer_read != buffer_.size();
+  }
+
+  return true;
+}
+
 // Serialization of base::Time.
 // We serialize to 'number of seconds since epoch' (represented as a double)
 // as this is consistent regardless of the underlying representation used in
@@ -46,7 +46,15 @@
 // There are currently two stream types defined: File*Stream, which uses a
 // FILE* under the hood; and Byte*Stream, which uses iterators to containers
 // of Bytes. Adding further stream types is trivial. Refer to to the comments/
-// declarations of File*Stream and Byte*Stream for details.
+// declarations of File*Stream and Byte*Stream for details. Furthermore,
+// ByteVectorOutStream appends to a ByteVector, and Buffered*Stream wraps
+// another stream so that it sees few large accesses rather than one per
+// primitive. This is worthwhile in front of a File*Stream.
+//
+// Vectors, strings and C-arrays of types for which IsBulkSerializable holds
+// are serialized in a single access to the stream rather than element by
+// element. This holds for the primitive types other than bool, and may be
+// extended to plain old data structs. See IsBulkSerializable for details.
 //
 // There is currently a single archive type defined, NativeBinary, which is a
 // non-portable binary format. Additional archive formats may be easily added
@@ -108,10 +116,12 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "base/logging.h"
+#include "base/macros.h"
 
 namespace core {
 
@@ -127,6 +137,18 @@ template<typename IteratorTag> struct IteratorsAreEqualFunctor;
 
 }  // namespace internal
 
+// This indicates whether the serialized form of an array of a given type is
+// the same as its representation in memory, in which case the array is
+// serialized with a single copy. This holds for the primitive types other
+// than bool, as they are serialized as-is. It may be specialized for a plain
+// old data struct, provided the struct has no padding and its Save and Load
+// functions serialize each of its members in order.
+template<typename T> struct IsBulkSerializable {
+  enum {
+    Value = std::is_arithmetic<T>::value && !std::is_same<T, bool>::value
+  };
+};
+
 // Serialization passes through these static functions before being routed
 // to 'Save' and 'Load' member functions. Overriding this function provides a
 // method to implement serialization for classes whose internals we can not
@@ -188,6 +210,19 @@ class InStream {
     return true;
   }
 
+  // Reads bytes without copying them, by returning a pointer to them in the
+  // memory backing the stream. This is only supported by streams over
+  // contiguous memory, such as a ByteInStream over a memory-mapped file. The
+  // bytes remain valid for as long as that memory does.
+  // @param length the number of bytes to read.
+  // @param bytes receives a pointer to the bytes that are read.
+  // @returns true if the entire length of bytes was read in place, false if
+  //     the stream doesn't support it or holds fewer bytes. The stream is left
+  //     untouched in that case, and may still be read from.
+  bool ReadInPlace(size_t length, const Byte** bytes) {
+    return ReadInPlaceImpl(length, bytes);
+  }
+
  protected:
   // Needs to be implemented by derived classes. See description of Read above.
   // @param length the number of bytes to read.
@@ -197,6 +232,15 @@ class InStream {
   //     possible for this to be any value from 0 to length, inclusive.
   // @returns true if the stream is reusable, false if it is errored.
   virtual bool ReadImpl(size_t length, Byte* bytes, size_t* bytes_read) = 0;
+
+  // May be implemented by derived classes. See description of ReadInPlace
+  // above.
+  // @param length the number of bytes to read.
+  // @param bytes receives a pointer to the bytes that are read.
+  // @returns true if the bytes were read in place, false otherwise.
+  virtual bool ReadInPlaceImpl(size_t length, const Byte** bytes) {
+    return false;
+  }
 };
 typedef std::unique_ptr<OutStream> ScopedOutStreamPtr;
 typedef std::unique_ptr<InStream> ScopedInStreamPtr;
@@ -226,6 +270,74 @@ class FileInStream : public InStream {
   FILE* file_;
 };
 
+// An OutStream that appends to a vector of bytes. Unlike a ByteOutStream over
+// a back_inserter, this appends each write in a single operation.
+class ByteVectorOutStream : public OutStream {
+ public:
+  explicit ByteVectorOutStream(ByteVector* bytes);
+  virtual ~ByteVectorOutStream() { }
+  virtual bool Write(size_t length, const Byte* bytes);
+
+ private:
+  ByteVector* bytes_;
+};
+
+// An OutStream that buffers the data written to it, and writes it to another
+// stream in chunks of a given size. Any data still buffered when this is
+// destroyed is written out, but the other stream isn't flushed.
+class BufferedOutStream : public OutStream {
+ public:
+  // The default size of the buffer.
+  static const size_t kDefaultBufferSize = 64 * 1024;
+
+  // @param out_stream The stream to write to. This must outlive this object.
+  // @param buffer_size The size of the buffer.
+  explicit BufferedOutStream(OutStream* out_stream);
+  BufferedOutStream(OutStream* out_stream, size_t buffer_size);
+  virtual ~BufferedOutStream();
+  virtual bool Write(size_t length, const Byte* bytes);
+  virtual bool Flush();
+
+ private:
+  // Writes the buffered data to out_stream_.
+  bool WriteBuffer();
+
+  OutStream* out_stream_;
+  ByteVector buffer_;
+  size_t buffer_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferedOutStream);
+};
+
+// An InStream that reads from another stream in chunks of a given size. As it
+// reads ahead, data past what has been read from this stream may already have
+// been consumed from the other one.
+class BufferedInStream : public InStream {
+ public:
+  // The default size of the buffer.
+  static const size_t kDefaultBufferSize = 64 * 1024;
+
+  // @param in_stream The stream to read from. This must outlive this object.
+  // @param buffer_size The size of the buffer.
+  explicit BufferedInStream(InStream* in_stream);
+  BufferedInStream(InStream* in_stream, size_t buffer_size);
+  virtual ~BufferedInStream() { }
+
+ protected:
+  virtual bool ReadImpl(size_t length, Byte* bytes, size_t* bytes_read);
+
+ private:
+  InStream* in_stream_;
+  ByteVector buffer_;
+  // The range of buffer_ that is yet to be read.
+  size_t buffer_begin_;
+  size_t buffer_end_;
+  // Set once in_stream_ has been exhausted.
+  bool at_end_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferedInStream);
+};
+
 // A simple OutStream wrapper for containers of bytes. Uses an output iterator
 // to push data to some container, or a pair of non-const iterators to write
 // data to a preallocated container. The underlying container should store
@@ -289,6 +401,7 @@ template<typename InputIterator> class ByteInStream : public InStream {
 
  protected:
   virtual bool ReadImpl(size_t length, Byte* bytes, size_t* bytes_read);
+  virtual bool ReadInPlaceImpl(size_t length, const Byte** bytes);
 
  private:
   InputIterator iter_;
@@ -344,6 +457,12 @@ class NativeBinaryOutArchive {
   NATIVE_BINARY_OUT_ARCHIVE_SAVE(unsigned long);
 #undef NATIVE_BINARY_OUT_ARCHIVE_SAVE
 
+  // Saves raw bytes. This is used to save arrays of bulk serializable types.
+  bool SaveBytes(size_t length, const Byte* bytes) {
+    DCHECK(out_stream_ != NULL);
+    return out_stream_->Write(length, bytes);
+  }
+
   bool Flush() { return out_stream_->Flush(); }
 
   OutStream* out_stream() { return out_stream_; }
@@ -393,6 +512,12 @@ class NativeBinaryInArchive {
   NATIVE_BINARY_IN_ARCHIVE_LOAD(unsigned long);
 #undef NATIVE_BINARY_IN_ARCHIVE_LOAD
 
+  // Loads raw bytes. This is used to load arrays of bulk serializable types.
+  bool LoadBytes(size_t length, Byte* bytes) {
+    DCHECK(in_stream_ != NULL);
+    return in_stream_->Read(length, bytes);
+  }
+
   InStream* in_stream() { return in_stream_; }
 
  private:
@@ -19,6 +19,8 @@
 #ifndef SYZYGY_CORE_SERIALIZATION_IMPL_H_
 #define SYZYGY_CORE_SERIALIZATION_IMPL_H_
 
+#include <string.h>
+#include <algorithm>
 #include <iterator>
 
 // Forward declare base::Time, defined in "base/time/time.h".
@@ -32,6 +34,11 @@ typedef struct _OMAP OMAP;
 
 namespace core {
 
+// OMAP is a pair of 32-bit RVAs, saved in order.
+template<> struct IsBulkSerializable<OMAP> {
+  enum { Value = 1 };
+};
+
 namespace internal {
 
 // This is for testing type equality.
@@ -64,6 +71,49 @@ template<> struct IteratorsAreEqualFunctor<std::output_iterator_tag> {
   }
 };
 
+// This reads bytes in place from a range of input iterators. It only does so
+// if the iterators are pointers, and thus traverse contiguous memory.
+template<typename InputIterator> bool ReadBytesInPlace(
+    size_t length, InputIterator end, InputIterator* iter, const Byte** bytes) {
+  return false;
+}
+template<typename ValueType> bool ReadBytesInPlace(
+    size_t length, ValueType* end, ValueType** iter, const Byte** bytes) {
+  DCHECK(iter != NULL);
+  DCHECK(bytes != NULL);
+
+  if (static_cast<size_t>(end - *iter) < length)
+    return false;
+  *bytes = reinterpret_cast<const Byte*>(*iter);
+  *iter += length;
+  return true;
+}
+
+// This reads bytes from a range of input iterators. It copies them all at once
+// if the iterators are pointers.
+// @returns the number of bytes read.
+template<typename InputIterator> size_t ReadBytes(
+    size_t length, InputIterator end, InputIterator* iter, Byte* bytes) {
+  DCHECK(iter != NULL);
+  DCHECK(bytes != NULL);
+
+  size_t i = 0;
+  for (; i < length && *iter != end; ++i, ++(*iter))
+    bytes[i] = static_cast<Byte>(**iter);
+  return i;
+}
+template<typename ValueType> size_t ReadBytes(
+    size_t length, ValueType* end, ValueType** iter, Byte* bytes) {
+  DCHECK(iter != NULL);
+  DCHECK(bytes != NULL);
+
+  size_t count = std::min(length, static_cast<size_t>(end - *iter));
+  if (count != 0)
+    ::memcpy(bytes, *iter, count);
+  *iter += count;
+  return count;
+}
+
 // Serialization for STL containers. This expects the container to implement
 // 'size', and iterators.
 template<class Container, class OutArchive> bool SaveContainer(
@@ -82,6 +132,35 @@ template<class Container, class OutArchive> bool SaveContainer(
   return true;
 }
 
+// Serialization for containers whose elements are contiguous in memory. This
+// expects the container to implement 'size', 'empty', iterators and
+// 'operator[]'. The elements are saved all at once if their type is bulk
+// serializable, and one at a time otherwise.
+template<class Container, class OutArchive> bool SaveContiguousContainer(
+    const Container& container, OutArchive* out_archive, std::false_type) {
+  return SaveContainer(container, out_archive);
+}
+template<class Container, class OutArchive> bool SaveContiguousContainer(
+    const Container& container, OutArchive* out_archive, std::true_type) {
+  DCHECK(out_archive != NULL);
+
+  if (!out_archive->Save(container.size()))
+    return false;
+  if (container.empty())
+    return true;
+
+  return out_archive->SaveBytes(
+      container.size() * sizeof(container[0]),
+      reinterpret_cast<const Byte*>(&container[0]));
+}
+template<class Container, class OutArchive> bool SaveContiguousContainer(
+    const Container& container, OutArchive* out_archive) {
+  typedef typename Container::value_type ValueType;
+  return SaveContiguousContainer(
+      container, out_archive,
+      std::integral_constant<bool, IsBulkSerializable<ValueType>::Value>());
+}
+
 // We use this type traits struct to get the value_type associated with a
 // given container. We require this to get around the pair<const, non-const>
 // value_type declaration of std::map.
@@ -150,6 +229,75 @@ bool LoadContainer(Container* container,
   return true;
 }
 
+// Loads a container whose elements are contiguous in memory. This expects the
+// container to implement 'resize' and 'operator[]', and to be empty. The
+// elements are loaded all at once if their type is bulk serializable, and one
+// at a time otherwise.
+template<class Container, class InArchive> bool LoadContiguousContainer(
+    Container* container, InArchive* in_archive, std::false_type) {
+  return LoadContainer(container, std::back_inserter(*container), in_archive);
+}
+template<class Container, class InArchive> bool LoadContiguousContainer(
+    Container* container, InArchive* in_archive, std::true_type) {
+  DCHECK(container != NULL);
+  DCHECK(in_archive != NULL);
+
+  typename Container::size_type size = 0;
+  if (!in_archive->Load(&size))
+    return false;
+
+  container->resize(size);
+  if (size == 0)
+    return true;
+
+  return in_archive->LoadBytes(size * sizeof((*container)[0]),
+                               reinterpret_cast<Byte*>(&(*container)[0]));
+}
+template<class Container, class InArchive> bool LoadContiguousContainer(
+    Container* container, InArchive* in_archive) {
+  DCHECK(container != NULL);
+  DCHECK(container->empty());
+  typedef typename Container::value_type ValueType;
+  return LoadContiguousContainer(
+      container, in_archive,
+      std::integral_constant<bool, IsBulkSerializable<ValueType>::Value>());
+}
+
+// Serialization for C-style arrays, element by element or all at once.
+template<typename Type, size_t Length, class OutArchive>
+bool SaveArray(const Type (&data)[Length], OutArchive* out_archive,
+               std::false_type) {
+  DCHECK(out_archive != NULL);
+  for (size_t i = 0; i < Length; ++i) {
+    if (!out_archive->Save(data[i]))
+      return false;
+  }
+  return true;
+}
+template<typename Type, size_t Length, class OutArchive>
+bool SaveArray(const Type (&data)[Length], OutArchive* out_archive,
+               std::true_type) {
+  DCHECK(out_archive != NULL);
+  return out_archive->SaveBytes(sizeof(data),
+                                reinterpret_cast<const Byte*>(data));
+}
+template<typename Type, size_t Length, class InArchive>
+bool LoadArray(Type (*data)[Length], InArchive* in_archive, std::false_type) {
+  DCHECK(data != NULL);
+  DCHECK(in_archive != NULL);
+  for (size_t i = 0; i < Length; ++i) {
+    if (!in_archive->Load(&((*data)[i])))
+      return false;
+  }
+  return true;
+}
+template<typename Type, size_t Length, class InArchive>
+bool LoadArray(Type (*data)[Length], InArchive* in_archive, std::true_type) {
+  DCHECK(data != NULL);
+  DCHECK(in_archive != NULL);
+  return in_archive->LoadBytes(sizeof(*data), reinterpret_cast<Byte*>(*data));
+}
+
 }  // namespace internal
 
 template<typename OutputIterator> bool ByteOutStream<OutputIterator>::Write(
@@ -170,18 +318,16 @@ template<typename InputIterator> bool ByteInStream<InputIterator>::ReadImpl(
   DCHECK(bytes != NULL);
   DCHECK(bytes_read != NULL);
 
-  Byte* bytes_start = bytes;
-  for (size_t i = 0; i < length; ++i, ++bytes) {
-    if (iter_ == end_)
-      break;
-    *bytes = static_cast<Byte>(*iter_);
-    ++iter_;
-  }
-
-  *bytes_read = static_cast<size_t>(bytes - bytes_start);
+  *bytes_read = internal::ReadBytes(length, end_, &iter_, bytes);
   return true;
 }
 
+template<typename InputIterator>
+bool ByteInStream<InputIterator>::ReadInPlaceImpl(size_t length,
+                                                  const Byte** bytes) {
+  return internal::ReadBytesInPlace(length, end_, &iter_, bytes);
+}
+
 // Default implementations of core::Save and core::Load.
 
 // This delegates to Data::Save.
@@ -205,7 +351,7 @@ template<typename Char, typename Traits, typename Alloc, class OutArchive>
 bool Save(const std::basic_string<Char, Traits, Alloc>& string,
           OutArchive* out_archive) {
   DCHECK(out_archive != NULL);
-  return internal::SaveContainer(string, out_archive);
+  return internal::SaveContiguousContainer(string, out_archive);
 }
 
 template<typename Key, typename Data, typename Compare, typename Alloc,
@@ -234,7 +380,7 @@ template<typename Type, typename Alloc, class OutArchive>
 bool Save(const std::vector<Type, Alloc>& vector,
           OutArchive* out_archive) {
   DCHECK(out_archive != NULL);
-  return internal::SaveContainer(vector, out_archive);
+  return internal::SaveContiguousContainer(vector, out_archive);
 }
 
 // Implementation of STL Load specializations.
@@ -245,9 +391,7 @@ bool Load(std::basic_string<Char, Traits, Alloc>* string,
   DCHECK(string != NULL);
   DCHECK(in_archive != NULL);
   string->clear();
-  return internal::LoadContainer(string,
-                                 std::back_inserter(*string),
-                                 in_archive);
+  return internal::LoadContiguousContainer(string, in_archive);
 }
 
 template<typename Key, typename Data, typename Compare, typename Alloc,
@@ -286,9 +430,8 @@ bool Load(std::vector<Type, Alloc>* vector,
           InArchive* in_archive) {
   DCHECK(vector != NULL);
   DCHECK(in_archive != NULL);
-  return internal::LoadContainer(vector,
-                                 std::back_inserter(*vector),
-                                 in_archive);
+  vector->clear();
+  return internal::LoadContiguousContainer(vector, in_archive);
 }
 
 // Implementation of serialization for C-style arrays.
@@ -296,22 +439,18 @@ bool Load(std::vector<Type, Alloc>* vector,
 template<typename Type, size_t Length, class OutArchive>
 bool Save(const Type (&data)[Length], OutArchive* out_archive) {
   DCHECK(out_archive != NULL);
-  for (size_t i = 0; i < Length; ++i) {
-    if (!out_archive->Save(data[i]))
-      return false;
-  }
-  return true;
+  return internal::SaveArray(
+      data, out_archive,
+      std::integral_constant<bool, IsBulkSerializable<Type>::Value>());
 }
 
 template<typename Type, size_t Length, class InArchive>
 bool Load(Type (*data)[Length], InArchive* in_archive) {
   DCHECK(data != NULL);
   DCHECK(in_archive != NULL);
-  for (size_t i = 0; i < Length; ++i) {
-    if (!in_archive->Load(&((*data)[i])))
-      return false;
-  }
-  return true;
+  return internal::LoadArray(
+      data, in_archive,
+      std::integral_constant<bool, IsBulkSerializable<Type>::Value>());
 }
 
 // Declaration of serialization for base::Time.
@@ -109,6 +109,96 @@ TEST_F(SerializationTest, IteratorInStream) {
   EXPECT_FALSE(in_stream->Read(sizeof(kTestData), buffer));
 }
 
+TEST_F(SerializationTest, ReadInPlace) {
+  // Streams over pointers read in place.
+  const Byte* data = kTestData;
+  ScopedInStreamPtr in_stream;
+  in_stream.reset(CreateByteInStream(data, data + sizeof(kTestData)));
+
+  const Byte* bytes = NULL;
+  EXPECT_TRUE(in_stream->ReadInPlace(2, &bytes));
+  EXPECT_EQ(data, bytes);
+  EXPECT_TRUE(in_stream->ReadInPlace(sizeof(kTestData) - 4, &bytes));
+  EXPECT_EQ(data + 2, bytes);
+
+  // Reading past the end fails, and leaves the stream untouched.
+  EXPECT_FALSE(in_stream->ReadInPlace(3, &bytes));
+  Byte buffer[2] = {};
+  EXPECT_TRUE(in_stream->Read(2, buffer));
+  EXPECT_EQ(0, memcmp(data + sizeof(kTestData) - 2, buffer, 2));
+
+  // Streams over other iterators don't.
+  ByteVector vector(data, data + sizeof(kTestData));
+  in_stream.reset(CreateByteInStream(vector.begin(), vector.end()));
+  EXPECT_FALSE(in_stream->ReadInPlace(2, &bytes));
+  EXPECT_TRUE(in_stream->Read(2, buffer));
+  EXPECT_EQ(0, memcmp(data, buffer, 2));
+}
+
+TEST_F(SerializationTest, ByteVectorOutStream) {
+  ByteVector bytes;
+  ByteVectorOutStream out_stream(&bytes);
+
+  EXPECT_TRUE(out_stream.Write(2, kTestData));
+  EXPECT_TRUE(out_stream.Write(0, NULL));
+  EXPECT_TRUE(out_stream.Write(sizeof(kTestData) - 2, kTestData + 2));
+  EXPECT_EQ(ByteVector(kTestData, kTestData + sizeof(kTestData)), bytes);
+}
+
+TEST_F(SerializationTest, BufferedOutStream) {
+  ByteVector bytes;
+  ByteVectorOutStream byte_stream(&bytes);
+  {
+    BufferedOutStream out_stream(&byte_stream, 4);
+
+    // Small writes are buffered until the buffer fills up.
+    EXPECT_TRUE(out_stream.Write(2, kTestData));
+    EXPECT_TRUE(out_stream.Write(2, kTestData + 2));
+    EXPECT_TRUE(bytes.empty());
+    EXPECT_TRUE(out_stream.Write(1, kTestData + 4));
+    EXPECT_EQ(4u, bytes.size());
+
+    // Large writes go straight through, after the buffered data.
+    EXPECT_TRUE(out_stream.Write(8, kTestData + 5));
+    EXPECT_EQ(13u, bytes.size());
+
+    // The rest is written when the stream is destroyed.
+    EXPECT_TRUE(out_stream.Write(sizeof(kTestData) - 13, kTestData + 13));
+  }
+  EXPECT_EQ(ByteVector(kTestData, kTestData + sizeof(kTestData)), bytes);
+
+  // Flushing writes out the buffered data.
+  bytes.clear();
+  BufferedOutStream out_stream(&byte_stream);
+  EXPECT_TRUE(out_stream.Write(2, kTestData));
+  EXPECT_TRUE(bytes.empty());
+  EXPECT_TRUE(out_stream.Flush());
+  EXPECT_EQ(ByteVector(kTestData, kTestData + 2), bytes);
+}
+
+TEST_F(SerializationTest, BufferedInStream) {
+  ByteVector vector(kTestData, kTestData + sizeof(kTestData));
+  ScopedInStreamPtr byte_stream;
+  byte_stream.reset(CreateByteInStream(vector.begin(), vector.end()));
+  BufferedInStream in_stream(byte_stream.get(), 4);
+
+  // Reads of any size, and straddling the buffer, should match the source
+  // data.
+  Byte buffer[sizeof(kTestData)] = {};
+  EXPECT_TRUE(in_stream.Read(1, buffer));
+  EXPECT_TRUE(in_stream.Read(5, buffer + 1));
+  EXPECT_TRUE(in_stream.Read(2, buffer + 6));
+  EXPECT_TRUE(in_stream.Read(sizeof(kTestData) - 9, buffer + 8));
+  EXPECT_EQ(0, memcmp(buffer, kTestData, sizeof(kTestData) - 1));
+
+  // A read past the end of the data is partial.
+  size_t bytes_read = 0;
+  EXPECT_TRUE(in_stream.Read(2, buffer, &bytes_read));
+  EXPECT_EQ(1u, bytes_read);
+  EXPECT_EQ(kTestData[sizeof(kTestData) - 1], buffer[0]);
+  EXPECT_FALSE(in_stream.Read(1, buffer));
+}
+
 TEST_F(SerializationTest, FileOutStream) {
   base::FilePath path;
   base::ScopedFILE file;
@@ -198,6 +288,67 @@ TEST_F(SerializationTest, StlTypesRoundTrip) {
   EXPECT_TRUE(TestRoundTrip(vector));
 }
 
+TEST_F(SerializationTest, BulkSerializableTypes) {
+  EXPECT_TRUE(IsBulkSerializable<char>::Value);
+  EXPECT_TRUE(IsBulkSerializable<uint32_t>::Value);
+  EXPECT_TRUE(IsBulkSerializable<double>::Value);
+  EXPECT_FALSE(IsBulkSerializable<bool>::Value);
+  EXPECT_FALSE(IsBulkSerializable<Foo>::Value);
+  EXPECT_FALSE(IsBulkSerializable<std::string>::Value);
+}
+
+TEST_F(SerializationTest, BulkSerializationFormat) {
+  // Arrays that are saved in bulk should be serialized the same way as they
+  // would be element by element.
+  std::vector<uint16_t> vector;
+  vector.push_back(1);
+  vector.push_back(2);
+  vector.push_back(0xFFFF);
+  std::vector<bool> bools(3, true);
+  ByteVector bytes;
+  ByteVectorOutStream out_stream(&bytes);
+  NativeBinaryOutArchive out_archive(&out_stream);
+  EXPECT_TRUE(out_archive.Save(vector));
+  EXPECT_TRUE(out_archive.Save(bools));
+
+  ByteVector expected_bytes;
+  ByteVectorOutStream expected_stream(&expected_bytes);
+  NativeBinaryOutArchive expected_archive(&expected_stream);
+  EXPECT_TRUE(expected_archive.Save(vector.size()));
+  for (size_t i = 0; i < vector.size(); ++i)
+    EXPECT_TRUE(expected_archive.Save(vector[i]));
+  EXPECT_TRUE(expected_archive.Save(bools.size()));
+  for (size_t i = 0; i < bools.size(); ++i)
+    EXPECT_TRUE(expected_archive.Save(static_cast<bool>(bools[i])));
+  EXPECT_EQ(expected_bytes, bytes);
+
+  // Loading a vector replaces its content.
+  ScopedInStreamPtr in_stream;
+  in_stream.reset(CreateByteInStream(bytes.begin(), bytes.end()));
+  NativeBinaryInArchive in_archive(in_stream.get());
+  std::vector<uint16_t> loaded_vector(1, 42);
+  std::vector<bool> loaded_bools;
+  EXPECT_TRUE(in_archive.Load(&loaded_vector));
+  EXPECT_TRUE(in_archive.Load(&loaded_bools));
+  EXPECT_EQ(vector, loaded_vector);
+  EXPECT_EQ(bools, loaded_bools);
+
+  // A truncated array can't be loaded.
+  in_stream.reset(CreateByteInStream(bytes.begin(), bytes.begin() + 10));
+  NativeBinaryInArchive truncated_archive(in_stream.get());
+  EXPECT_FALSE(truncated_archive.Load(&loaded_vector));
+}
+
+TEST_F(SerializationTest, BulkTypesRoundTrip) {
+  std::vector<uint64_t> vector(1000);
+  for (size_t i = 0; i < vector.size(); ++i)
+    vector[i] = i * i;
+  EXPECT_TRUE(TestRoundTrip(vector));
+  EXPECT_TRUE(TestRoundTrip(std::vector<uint64_t>()));
+  EXPECT_TRUE(TestRoundTrip(std::string()));
+  EXPECT_TRUE(TestRoundTrip(std::vector<std::string>(3, "string")));
+}
+
 TEST_F(SerializationTest, CustomTypeRoundTrip) {
   const char string[] = "I'm fond of jellybeans.";
 
@@ -15,11 +15,96 @@
 
 #include "syzygy/core/string_table.h"
 
+#include "base/logging.h"
+
 namespace core {
 
+namespace {
+
+// The number of bits of the hash that select the shard of a string. These are
+// the top bits, while the bottom ones select its slot within the shard.
+const size_t kShardBits = 4;
+
+}  // namespace
+
+const size_t StringTable::kShardCount;
+const size_t StringTable::kInitialSlotCount;
+
+StringTable::StringTable() {
+  static_assert(kShardCount == (1 << kShardBits),
+                "kShardBits doesn't match kShardCount.");
+}
+
+StringTable::~StringTable() {
+}
+
 const std::string& StringTable::InternString(const base::StringPiece& str) {
-  std::string value(str.data(), str.size());
-  return *(string_table_.insert(value).first);
+  uint32_t hash = Hash(str);
+  Shard& shard = shards_[hash >> (32 - kShardBits)];
+
+  base::AutoLock auto_lock(shard.lock);
+
+  // Keep the load factor of the table at or below 3/4.
+  if ((shard.strings.size() + 1) * 4 > shard.slots.size() * 3)
+    Grow(&shard);
+
+  size_t mask = shard.slots.size() - 1;
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    Slot& slot = shard.slots[i];
+    if (slot.index == 0) {
+      shard.strings.push_back(str.as_string());
+      slot.hash = hash;
+      slot.index = static_cast<uint32_t>(shard.strings.size());
+      return shard.strings.back();
+    }
+
+    if (slot.hash == hash) {
+      const std::string& candidate = shard.strings[slot.index - 1];
+      if (base::StringPiece(candidate) == str)
+        return candidate;
+    }
+  }
+}
+
+size_t StringTable::size() const {
+  size_t size = 0;
+  for (size_t i = 0; i < kShardCount; ++i) {
+    base::AutoLock auto_lock(shards_[i].lock);
+    size += shards_[i].strings.size();
+  }
+  return size;
+}
+
+uint32_t StringTable::Hash(const base::StringPiece& str) {
+  // This is the 32-bit FNV-1a hash.
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < str.size(); ++i) {
+    hash ^= static_cast<uint8_t>(str[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+void StringTable::Grow(Shard* shard) {
+  DCHECK(shard != NULL);
+  shard->lock.AssertAcquired();
+
+  size_t slot_count = shard->slots.size() * 2;
+  if (slot_count == 0)
+    slot_count = kInitialSlotCount;
+
+  // Rehash the occupied slots by their recorded hash.
+  std::vector<Slot> slots(slot_count, Slot());
+  size_t mask = slot_count - 1;
+  for (const Slot& slot : shard->slots) {
+    if (slot.index == 0)
+      continue;
+    size_t i = slot.hash & mask;
+    while (slots[i].index != 0)
+      i = (i + 1) & mask;
+    slots[i] = slot;
+  }
+  shard->slots.swap(slots);
 }
 
 }  // namespace core
@@ -23,33 +23,77 @@
 // const std::string& str2 = strtab.InternString("dummy");
 //
 // str1 and str2 are the same instance of a string holding the value "dummy".
+//
+// The strings are held in an append-only store, and found through an
+// open-addressing hash table that records the hash of each string alongside
+// it. The table is split into shards, each with its own lock, so that several
+// threads can intern strings concurrently.
 
 #ifndef SYZYGY_CORE_STRING_TABLE_H_
 #define SYZYGY_CORE_STRING_TABLE_H_
 
 #include <stdint.h>
-#include <set>
+#include <deque>
 #include <string>
+#include <vector>
 
+#include "base/macros.h"
 #include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
 
 namespace core {
 
 class StringTable {
  public:
   // Default constructor.
-  StringTable() {
-  }
+  StringTable();
+  ~StringTable();
 
   // A pool of strings is maintained privately. If the pool already contains a
   // string equal to @p str, then the string from the pool is returned.
   // Otherwise, the string is added to the pool and a reference is returned.
+  // This is thread-safe.
   // @param str The string to internalized.
   // @returns a canonical representation for this string.
   const std::string& InternString(const base::StringPiece& str);
 
+  // @returns the number of strings in the pool.
+  size_t size() const;
+
  protected:
-  std::set<std::string> string_table_;
+  // The number of shards, which must be a power of two.
+  static const size_t kShardCount = 16;
+  // The initial number of slots of the hash table of a shard.
+  static const size_t kInitialSlotCount = 64;
+
+  // A slot of the hash table of a shard.
+  struct Slot {
+    // The hash of the string in this slot.
+    uint32_t hash;
+    // The index of the string in this slot plus one, or zero if the slot is
+    // empty.
+    uint32_t index;
+  };
+
+  // A shard of the pool. The strings whose hash selects a shard are all
+  // interned there.
+  struct Shard {
+    // Protects the members below.
+    mutable base::Lock lock;
+    // The strings. A deque never moves its elements as it grows.
+    std::deque<std::string> strings;
+    // The hash table, whose size is a power of two.
+    std::vector<Slot> slots;
+  };
+
+  // @returns the hash of @p str.
+  static uint32_t Hash(const base::StringPiece& str);
+
+  // Doubles the size of the hash table of @p shard, or initializes it.
+  // @param shard The shard to grow. Its lock must be held.
+  static void Grow(Shard* shard);
+
+  Shard shards_[kShardCount];
 
  private:
   DISALLOW_COPY_AND_ASSIGN(StringTable);
@@ -14,6 +14,11 @@
 
 #include "syzygy/core/string_table.h"
 
+#include <memory>
+#include <vector>
+
+#include "base/strings/stringprintf.h"
+#include "base/threading/simple_thread.h"
 #include "gtest/gtest.h"
 
 namespace core {
@@ -22,21 +27,42 @@ namespace {
 
 class TestStringTable : public StringTable {
  public:
-  using StringTable::string_table_;
+  using StringTable::kShardCount;
+  using StringTable::shards_;
+};
+
+// Interns the same strings as all of the other threads running it.
+class InternStringsDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  InternStringsDelegate(StringTable* strtab,
+                        std::vector<const std::string*>* interned)
+      : strtab_(strtab), interned_(interned) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < interned_->size(); ++i) {
+      std::string str = base::StringPrintf("string %d", static_cast<int>(i));
+      (*interned_)[i] = &strtab_->InternString(str);
+    }
+  }
+
+ private:
+  StringTable* strtab_;
+  std::vector<const std::string*>* interned_;
 };
 
 }  // namespace
 
 TEST(StringTableTest, DefaultConstructor) {
   TestStringTable strtab;
-  EXPECT_TRUE(strtab.string_table_.empty());
+  EXPECT_EQ(0U, strtab.size());
 }
 
 TEST(StringTableTest, InternString) {
   TestStringTable strtab;
 
   // The pool is initially empty.
-  EXPECT_EQ(0U, strtab.string_table_.size());
+  EXPECT_EQ(0U, strtab.size());
 
   const std::string& str1 = strtab.InternString("foo");
   const std::string& str2 = strtab.InternString("bar");
@@ -45,7 +71,7 @@ TEST(StringTableTest, InternString) {
   const std::string& str5 = strtab.InternString("bat");
 
   // Validate the size of the internal strings pool.
-  EXPECT_EQ(3U, strtab.string_table_.size());
+  EXPECT_EQ(3U, strtab.size());
 
   // Validate string sharing.
   EXPECT_FALSE(str1.c_str() == str2.c_str());
@@ -54,4 +80,60 @@ TEST(StringTableTest, InternString) {
   EXPECT_FALSE(str1.c_str() == str5.c_str());
 }
 
+TEST(StringTableTest, InternManyStrings) {
+  TestStringTable strtab;
+
+  // Enough strings to grow the hash table of every shard several times.
+  const size_t kStringCount = 10000;
+  std::vector<const std::string*> interned;
+  for (size_t i = 0; i < kStringCount; ++i) {
+    std::string str = base::StringPrintf("s%d", static_cast<int>(i));
+    interned.push_back(&strtab.InternString(str));
+  }
+  EXPECT_EQ(kStringCount, strtab.size());
+
+  // The strings haven't moved, and are found again.
+  for (size_t i = 0; i < kStringCount; ++i) {
+    std::string str = base::StringPrintf("s%d", static_cast<int>(i));
+    EXPECT_EQ(str, *interned[i]);
+    EXPECT_EQ(interned[i], &strtab.InternString(str));
+  }
+  EXPECT_EQ(kStringCount, strtab.size());
+
+  // The strings are spread over the shards.
+  for (size_t i = 0; i < TestStringTable::kShardCount; ++i)
+    EXPECT_LT(0U, strtab.shards_[i].strings.size());
+
+  // The empty string and strings with embedded NULs are strings like others.
+  const std::string& empty = strtab.InternString("");
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(&empty, &strtab.InternString(base::StringPiece()));
+  const std::string& nul = strtab.InternString(base::StringPiece("a\0b", 3));
+  EXPECT_EQ(3U, nul.size());
+  EXPECT_NE(&nul, &strtab.InternString("a"));
+}
+
+TEST(StringTableTest, ConcurrentInternString) {
+  StringTable strtab;
+
+  const size_t kThreadCount = 4;
+  const size_t kStringCount = 1000;
+  std::vector<std::vector<const std::string*>> interned(
+      kThreadCount, std::vector<const std::string*>(kStringCount));
+  std::vector<std::unique_ptr<InternStringsDelegate>> delegates;
+  base::DelegateSimpleThreadPool pool("StringTableTest", kThreadCount);
+  pool.Start();
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    delegates.push_back(std::unique_ptr<InternStringsDelegate>(
+        new InternStringsDelegate(&strtab, &interned[i])));
+    pool.AddWork(delegates.back().get(), 1);
+  }
+  pool.JoinAll();
+
+  // All threads got the same instances.
+  EXPECT_EQ(kStringCount, strtab.size());
+  for (size_t i = 1; i < kThreadCount; ++i)
+    EXPECT_EQ(interned[0], interned[i]);
+}
+
 }  // namespace core
@@ -14,6 +14,11 @@
 
 #include "syzygy/core/zstream.h"
 
+#include <algorithm>
+
+#include "base/atomicops.h"
+#include "base/macros.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/core/serialization.h"
 #include "third_party/zlib/zlib.h"
 
@@ -27,6 +32,105 @@ namespace {
 // grow dynamically so we simply use a page of memory.
 static const size_t kZStreamBufferSize = 4096;
 
+// The deflate window bits used for the raw chunks. This is the same window
+// size as the zlib default, so the zlib header is the usual one.
+static const int kRawWindowBits = -15;
+
+// Compresses a chunk to raw deflate data. Chunks that don't finish the stream
+// end with a full flush, so that they are byte aligned and don't depend on
+// the data that precedes them.
+// @param level the compression level.
+// @param input the chunk to compress.
+// @param finish whether this chunk ends the stream.
+// @param output receives the compressed chunk.
+// @returns true on success, false otherwise.
+bool CompressChunk(int level,
+                   const std::vector<uint8_t>& input,
+                   bool finish,
+                   std::vector<uint8_t>* output) {
+  DCHECK(output != NULL);
+
+  z_stream zstream = {};
+  int ret = deflateInit2(&zstream, level, Z_DEFLATED, kRawWindowBits, 8,
+                         Z_DEFAULT_STRATEGY);
+  if (ret != Z_OK) {
+    LOG(ERROR) << "deflateInit2 returned " << ret << ".";
+    return false;
+  }
+
+  // Leave room for the empty stored block emitted by the flush.
+  output->resize(deflateBound(&zstream, static_cast<uLong>(input.size())) + 8);
+  zstream.next_in = const_cast<Bytef*>(input.data());
+  zstream.avail_in = static_cast<uInt>(input.size());
+  zstream.next_out = output->data();
+  zstream.avail_out = static_cast<uInt>(output->size());
+
+  ret = deflate(&zstream, finish ? Z_FINISH : Z_FULL_FLUSH);
+  bool succeeded = finish ? ret == Z_STREAM_END :
+      ret == Z_OK && zstream.avail_in == 0 && zstream.avail_out != 0;
+  if (!succeeded) {
+    LOG(ERROR) << "zlib deflate returned " << ret << " for a chunk.";
+  } else {
+    output->resize(output->size() - zstream.avail_out);
+  }
+
+  deflateEnd(&zstream);
+  return succeeded;
+}
+
+// Compresses a batch of chunks concurrently.
+class ChunkCompressor : public base::DelegateSimpleThread::Delegate {
+ public:
+  ChunkCompressor(int level,
+                  const std::vector<std::vector<uint8_t>>& inputs,
+                  bool finish)
+      : level_(level), inputs_(inputs), finish_(finish),
+        outputs_(inputs.size()), adlers_(inputs.size(), 0),
+        next_index_(0), failed_(0) {
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, inputs_.size());
+    if (!Compress(index))
+      base::subtle::NoBarrier_Store(&failed_, 1);
+  }
+  // @}
+
+  // Compresses a chunk of the batch, and computes its checksum.
+  // @param index the index of the chunk.
+  // @returns true on success, false otherwise.
+  bool Compress(size_t index) {
+    const std::vector<uint8_t>& input = inputs_[index];
+    adlers_[index] = adler32(adler32(0, Z_NULL, 0), input.data(),
+                             static_cast<uInt>(input.size()));
+    bool finish = finish_ && index + 1 == inputs_.size();
+    return CompressChunk(level_, input, finish, &outputs_[index]);
+  }
+
+  // @name Accessors.
+  // @{
+  bool failed() const { return base::subtle::NoBarrier_Load(&failed_) != 0; }
+  const std::vector<std::vector<uint8_t>>& outputs() const { return outputs_; }
+  const std::vector<uLong>& adlers() const { return adlers_; }
+  // @}
+
+ private:
+  int level_;
+  const std::vector<std::vector<uint8_t>>& inputs_;
+  bool finish_;
+  std::vector<std::vector<uint8_t>> outputs_;
+  std::vector<uLong> adlers_;
+
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkCompressor);
+};
+
 }  // namespace
 
 void ZOutStream::z_stream_s_close::operator()(z_stream_s* zstream) const {
@@ -37,7 +141,9 @@ void ZOutStream::z_stream_s_close::operator()(z_stream_s* zstream) const {
 }
 
 ZOutStream::ZOutStream(OutStream* out_stream)
-    : out_stream_(out_stream), buffer_(kZStreamBufferSize, 0) {
+    : out_stream_(out_stream), buffer_(kZStreamBufferSize, 0),
+      level_(Z_DEFAULT_COMPRESSION), threads_(0), adler_(0),
+      uncompressed_size_(0), compressed_size_(0) {
 }
 
 ZOutStream::~ZOutStream() { }
@@ -47,11 +153,23 @@ bool ZOutStream::Init() {
 }
 
 bool ZOutStream::Init(int level) {
+  return Init(level, 1);
+}
+
+bool ZOutStream::Init(int level, size_t threads) {
   DCHECK(level == Z_DEFAULT_COMPRESSION || (level >= 0 && level <= 9));
+  DCHECK_LT(0u, threads);
 
-  if (zstream_ != NULL)
+  if (zstream_ != NULL || threads_ != 0)
     return true;
 
+  if (threads > 1) {
+    level_ = level;
+    threads_ = threads;
+    adler_ = adler32(0, Z_NULL, 0);
+    return true;
+  }
+
   std::unique_ptr<z_stream_s> zstream(new z_stream_s);
   ::memset(zstream.get(), 0, sizeof(*zstream.get()));
 
@@ -71,6 +189,27 @@ bool ZOutStream::Init(int level) {
 }
 
 bool ZOutStream::Write(size_t length, const Byte* bytes) {
+  if (threads_ != 0) {
+    // Append the data to the pending chunks, compressing a batch whenever
+    // there's a full chunk for each thread.
+    while (length > 0) {
+      if (pending_chunks_.empty() ||
+          pending_chunks_.back().size() == kChunkSize) {
+        if (pending_chunks_.size() == threads_ && !CompressChunks(false))
+          return false;
+        pending_chunks_.push_back(std::vector<uint8_t>());
+        pending_chunks_.back().reserve(kChunkSize);
+      }
+
+      std::vector<uint8_t>& chunk = pending_chunks_.back();
+      size_t count = std::min(length, kChunkSize - chunk.size());
+      chunk.insert(chunk.end(), bytes, bytes + count);
+      bytes += count;
+      length -= count;
+    }
+    return true;
+  }
+
   DCHECK(zstream_.get() != NULL);
   DCHECK_EQ(buffer_.size(), kZStreamBufferSize);
 
@@ -100,6 +239,25 @@ bool ZOutStream::Write(size_t length, const Byte* bytes) {
 }
 
 bool ZOutStream::Flush() {
+  if (threads_ != 0) {
+    // The last chunk finishes the stream, even if it's empty.
+    if (pending_chunks_.empty())
+      pending_chunks_.push_back(std::vector<uint8_t>());
+    if (!CompressChunks(true))
+      return false;
+
+    // Output the checksum, MSB first.
+    Byte trailer[4] = { static_cast<Byte>(adler_ >> 24),
+                        static_cast<Byte>(adler_ >> 16),
+                        static_cast<Byte>(adler_ >> 8),
+                        static_cast<Byte>(adler_) };
+    if (!WriteCompressed(sizeof(trailer), trailer))
+      return false;
+
+    threads_ = 0;
+    return true;
+  }
+
   DCHECK(zstream_.get() != NULL);
   DCHECK_EQ(buffer_.size(), kZStreamBufferSize);
 
@@ -142,6 +300,83 @@ bool ZOutStream::FlushBuffer() {
   return true;
 }
 
+bool ZOutStream::CompressChunks(bool finish) {
+  DCHECK_NE(0u, threads_);
+  DCHECK(!pending_chunks_.empty());
+
+  ChunkCompressor compressor(level_, pending_chunks_, finish);
+  if (pending_chunks_.size() == 1) {
+    if (!compressor.Compress(0))
+      return false;
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "ZOutStream",
+        static_cast<int>(std::min(threads_, pending_chunks_.size())));
+    pool.Start();
+    pool.AddWork(&compressor, static_cast<int>(pending_chunks_.size()));
+    pool.JoinAll();
+    if (compressor.failed())
+      return false;
+  }
+
+  // Output the compressed chunks in order.
+  for (size_t i = 0; i < pending_chunks_.size(); ++i) {
+    const std::vector<uint8_t>& output = compressor.outputs()[i];
+    size_t size = pending_chunks_[i].size();
+
+    // Ensure the header precedes the first boundary.
+    if (!WriteCompressed(0, NULL))
+      return false;
+    ChunkBoundary boundary = { uncompressed_size_, compressed_size_ };
+    chunk_boundaries_.push_back(boundary);
+
+    if (!WriteCompressed(output.size(), output.data()))
+      return false;
+    adler_ = adler32_combine(adler_, compressor.adlers()[i],
+                             static_cast<z_off_t>(size));
+    uncompressed_size_ += size;
+  }
+  pending_chunks_.clear();
+
+  return true;
+}
+
+bool ZOutStream::WriteCompressed(size_t length, const Byte* bytes) {
+  if (compressed_size_ == 0) {
+    // Output the zlib header: deflate with a 32K window, and the level in the
+    // flags. This mirrors what deflate itself outputs.
+    uint32_t level_flags = 0;
+    if (level_ == Z_DEFAULT_COMPRESSION || level_ == 6)
+      level_flags = 2;
+    else if (level_ < 2)
+      level_flags = 0;
+    else if (level_ < 6)
+      level_flags = 1;
+    else
+      level_flags = 3;
+    uint32_t header = (0x78 << 8) | (level_flags << 6);
+    header += 31 - (header % 31);
+    Byte header_bytes[2] = { static_cast<Byte>(header >> 8),
+                             static_cast<Byte>(header) };
+    if (!out_stream_->Write(sizeof(header_bytes), header_bytes)) {
+      LOG(ERROR) << "Unable to write compressed stream.";
+      return false;
+    }
+    compressed_size_ = sizeof(header_bytes);
+  }
+
+  if (length == 0)
+    return true;
+
+  if (!out_stream_->Write(length, bytes)) {
+    LOG(ERROR) << "Unable to write compressed stream.";
+    return false;
+  }
+  compressed_size_ += length;
+
+  return true;
+}
+
 void ZInStream::z_stream_s_close::operator()(z_stream_s* zstream) const {
   if (zstream != NULL) {
     inflateEnd(zstream);
@@ -13,11 +13,19 @@
 // limitations under the License.
 //
 // Defines simple streams which can zlib compress or decompress data.
+//
+// ZOutStream optionally compresses its input on several threads, pigz-style.
+// The input is then split into chunks that are deflated independently and
+// concurrently, and the compressed chunks are concatenated into a single zlib
+// stream. This is readable by any zlib decompressor, ZInStream included. As
+// the chunks don't share a dictionary decompression may also start at any
+// chunk boundary, at the cost of a slightly lower compression ratio.
 
 #ifndef SYZYGY_CORE_ZSTREAM_H_
 #define SYZYGY_CORE_ZSTREAM_H_
 
 #include <memory>
+#include <vector>
 
 #include "syzygy/core/serialization.h"
 
@@ -46,16 +54,38 @@ class ZOutStream : public OutStream {
   static const int kZBestSpeed = 1;
   static const int kZBestCompression = 9;
 
+  // The size of the chunks that are compressed concurrently, in uncompressed
+  // bytes.
+  static const size_t kChunkSize = 128 * 1024;
+
+  // Describes where a chunk starts, when compressing on several threads.
+  struct ChunkBoundary {
+    // The offset of the chunk in the uncompressed data.
+    size_t uncompressed_offset;
+    // The offset of the compressed chunk from the start of the zlib stream.
+    // A raw inflate started at this offset decompresses the chunk.
+    size_t compressed_offset;
+  };
+
   // @{
   // Initializes this compressor. Must be called prior to calling Write.
   // @param level the level of compression. Must be kZDefaultCompression (-1),
   //     or an integer in the range 0..9, inclusive. If not provided defaults to
-  //     Z_DEFAULT_COMPRESSION.
+  //     Z_DEFAULT_COMPRESSION. Lower levels are faster.
+  // @param threads the number of threads compressing the data. More than one
+  //     enables the chunked mode described above. Defaults to one.
   // @returns true on success, false otherwise.
   bool Init();
   bool Init(int level);
+  bool Init(int level, size_t threads);
   // @}
 
+  // @returns the boundaries of the chunks that have been output so far. This
+  //     is only populated when compressing on several threads.
+  const std::vector<ChunkBoundary>& chunk_boundaries() const {
+    return chunk_boundaries_;
+  }
+
   // @name OutStream implementation.
   // @{
   // Writes the given buffer of data to the stream. This may or may not produce
@@ -81,9 +111,38 @@ class ZOutStream : public OutStream {
 
   bool FlushBuffer();
 
+  // @name Chunked mode helpers.
+  // @{
+  // Compresses the pending chunks concurrently and outputs them.
+  // @param finish whether the last pending chunk ends the stream.
+  // @returns true on success, false otherwise.
+  bool CompressChunks(bool finish);
+  // Outputs compressed data, preceded by the zlib header if need be.
+  // @returns true on success, false otherwise.
+  bool WriteCompressed(size_t length, const Byte* bytes);
+  // @}
+
   std::unique_ptr<z_stream_s, z_stream_s_close> zstream_;
   OutStream* out_stream_;
   std::vector<uint8_t> buffer_;
+
+  // @name Chunked mode state.
+  // @{
+  // The compression level and the number of threads. The latter is zero
+  // unless the stream was initialized in chunked mode and isn't yet flushed.
+  int level_;
+  size_t threads_;
+  // The uncompressed chunks awaiting compression. Only the last one may be
+  // partially filled.
+  std::vector<std::vector<uint8_t>> pending_chunks_;
+  // The running Adler-32 checksum of the uncompressed data that was output.
+  unsigned long adler_;  // NOLINT
+  // The number of uncompressed and compressed bytes output so far. The latter
+  // includes the zlib header.
+  size_t uncompressed_size_;
+  size_t compressed_size_;
+  std::vector<ChunkBoundary> chunk_boundaries_;
+  // @}
 };
 
 // A zlib decompressing in-stream, decompressing the data from the chained
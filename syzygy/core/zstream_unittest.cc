@@ -14,9 +14,12 @@
 
 #include "syzygy/core/zstream.h"
 
+#include <algorithm>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/serialization.h"
+#include "third_party/zlib/zlib.h"
 
 namespace core {
 
@@ -134,4 +137,85 @@ TEST(ZStreamTest, RoundTrip) {
   EXPECT_THAT(decompressed, testing::ElementsAreArray(kSampleData));
 }
 
+TEST(ZStreamTest, ChunkedRoundTrip) {
+  // Generate a few chunks worth of compressible data, ending with a partial
+  // chunk.
+  std::vector<uint8_t> data(ZOutStream::kChunkSize * 5 / 2);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = kSampleData[(i * 7 + i / 1024) % sizeof(kSampleData)];
+
+  std::vector<uint8_t> compressed;
+  ScopedOutStreamPtr out_stream(
+      CreateByteOutStream(std::back_inserter(compressed)));
+  ZOutStream zip_stream(out_stream.get());
+  EXPECT_TRUE(zip_stream.Init(ZOutStream::kZBestSpeed, 2));
+  EXPECT_TRUE(zip_stream.Write(data.size() / 3, &data[0]));
+  EXPECT_TRUE(zip_stream.Write(data.size() - data.size() / 3,
+                               &data[data.size() / 3]));
+  EXPECT_TRUE(zip_stream.Flush());
+  EXPECT_LT(0u, compressed.size());
+  EXPECT_GT(data.size(), compressed.size());
+
+  // The output is a plain zlib stream.
+  ScopedInStreamPtr in_stream(
+      CreateByteInStream(compressed.begin(), compressed.end()));
+  ZInStream unzip_stream(in_stream.get());
+  EXPECT_TRUE(unzip_stream.Init());
+  std::vector<uint8_t> decompressed(data.size() + 1);
+  size_t bytes_read = 0;
+  EXPECT_TRUE(unzip_stream.Read(decompressed.size(), &decompressed[0],
+                                &bytes_read));
+  EXPECT_EQ(data.size(), bytes_read);
+  decompressed.resize(bytes_read);
+  EXPECT_EQ(data, decompressed);
+
+  // Decompression may start at any chunk boundary.
+  const std::vector<ZOutStream::ChunkBoundary>& boundaries =
+      zip_stream.chunk_boundaries();
+  ASSERT_EQ(3u, boundaries.size());
+  EXPECT_EQ(0u, boundaries[0].uncompressed_offset);
+  EXPECT_EQ(2u, boundaries[0].compressed_offset);
+  for (size_t i = 1; i < boundaries.size(); ++i) {
+    const ZOutStream::ChunkBoundary& boundary = boundaries[i];
+    EXPECT_EQ(i * ZOutStream::kChunkSize, boundary.uncompressed_offset);
+
+    z_stream zstream = {};
+    ASSERT_EQ(Z_OK, inflateInit2(&zstream, -15));
+    std::vector<uint8_t> chunk(ZOutStream::kChunkSize);
+    zstream.next_in = &compressed[boundary.compressed_offset];
+    zstream.avail_in =
+        static_cast<uInt>(compressed.size() - boundary.compressed_offset);
+    zstream.next_out = &chunk[0];
+    zstream.avail_out = static_cast<uInt>(chunk.size());
+    int ret = inflate(&zstream, Z_SYNC_FLUSH);
+    EXPECT_TRUE(ret == Z_OK || ret == Z_STREAM_END);
+    size_t expected_size = std::min(ZOutStream::kChunkSize,
+                                    data.size() - boundary.uncompressed_offset);
+    ASSERT_LE(expected_size, zstream.total_out);
+    EXPECT_EQ(0, ::memcmp(&chunk[0], &data[boundary.uncompressed_offset],
+                          expected_size));
+    inflateEnd(&zstream);
+  }
+}
+
+TEST(ZStreamTest, ChunkedEmptyStream) {
+  std::vector<uint8_t> compressed;
+  ScopedOutStreamPtr out_stream(
+      CreateByteOutStream(std::back_inserter(compressed)));
+  ZOutStream zip_stream(out_stream.get());
+  EXPECT_TRUE(zip_stream.Init(ZOutStream::kZDefaultCompression, 4));
+  EXPECT_EQ(0u, compressed.size());
+  EXPECT_TRUE(zip_stream.Flush());
+  EXPECT_LT(0u, compressed.size());
+
+  ScopedInStreamPtr in_stream(
+      CreateByteInStream(compressed.begin(), compressed.end()));
+  ZInStream unzip_stream(in_stream.get());
+  EXPECT_TRUE(unzip_stream.Init());
+  uint8_t buffer[1] = {};
+  size_t bytes_read = 0;
+  EXPECT_TRUE(unzip_stream.Read(sizeof(buffer), buffer, &bytes_read));
+  EXPECT_EQ(0u, bytes_read);
+}
+
 }  // namespace core
@@ -17,9 +17,12 @@
 // We use standard dependencies only, as we don't want to introduce a
 // dependency on base into the backend crash processing code.
 #include <assert.h>
-#include <iomanip>
-#include <iostream>
-#include <sstream>
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
 
 namespace crashdata {
 
@@ -27,6 +30,63 @@ namespace {
 
 const size_t kIndentSize = 2;
 
+// Accumulates output in a fixed-size buffer and hands it to a sink whenever
+// the buffer fills up, so that the cost of emitting a value doesn't depend on
+// the amount of output produced before it. Also carries the options of the
+// conversion.
+class JsonWriter {
+ public:
+  JsonWriter(const JsonOptions& options, JsonSink* sink)
+      : options_(options),
+        sink_(sink),
+        buffer_(new char[kBufferSize]),
+        size_(0),
+        failed_(false) {
+    assert(sink != nullptr);
+  }
+
+  const JsonOptions& options() const { return options_; }
+
+  void push_back(char c) {
+    if (size_ == kBufferSize)
+      Flush();
+    buffer_[size_++] = c;
+  }
+
+  void append(const char* data, size_t length) {
+    while (length > 0) {
+      if (size_ == kBufferSize)
+        Flush();
+      size_t chunk = std::min(length, kBufferSize - size_);
+      ::memcpy(buffer_.get() + size_, data, chunk);
+      size_ += chunk;
+      data += chunk;
+      length -= chunk;
+    }
+  }
+
+  void append(const char* s) { append(s, ::strlen(s)); }
+  void append(const std::string& s) { append(s.data(), s.size()); }
+
+  // Hands the buffered output to the sink.
+  // @returns false if the sink has failed at any point.
+  bool Flush() {
+    if (size_ > 0 && !failed_ && !sink_->Write(buffer_.get(), size_))
+      failed_ = true;
+    size_ = 0;
+    return !failed_;
+  }
+
+ private:
+  static const size_t kBufferSize = 64 * 1024;
+
+  const JsonOptions& options_;
+  JsonSink* sink_;
+  std::unique_ptr<char[]> buffer_;
+  size_t size_;
+  bool failed_;
+};
+
 void IncreaseIndent(std::string* indent) {
   if (!indent)
     return;
@@ -39,66 +99,92 @@ void DecreaseIndent(std::string* indent) {
   indent->resize(indent->size() - kIndentSize);
 }
 
-void EmitIndent(std::string* indent, std::string* output) {
+void EmitIndent(std::string* indent, JsonWriter* output) {
   assert(output != nullptr);
   if (!indent)
     return;
   output->append(*indent);
 }
 
-void EmitHexValue8(unsigned char value, std::string* output) {
+const char kHexDigits[] = "0123456789ABCDEF";
+
+void EmitHexValue8(unsigned char value, JsonWriter* output) {
   assert(output != nullptr);
-  output->push_back('"');
-  std::ostringstream oss;
-  oss << "0x" << std::hex << std::setfill('0') << std::setw(2)
-      << std::uppercase << static_cast<unsigned int>(value);
-  output->append(oss.str());
-  output->push_back('"');
+  const char hex[] = {
+      '"', '0', 'x', kHexDigits[value >> 4], kHexDigits[value & 0xF], '"'};
+  output->append(hex, sizeof(hex));
 }
 
-void EmitHexValue32(google::protobuf::uint64 value, std::string* output) {
+void EmitHexValue32(google::protobuf::uint64 value, JsonWriter* output) {
   assert(output != nullptr);
-  output->push_back('"');
-  std::ostringstream oss;
-  oss << "0x" << std::hex << std::setfill('0') << std::setw(8)
-      << std::uppercase << value;
-  output->append(oss.str());
-  output->push_back('"');
+  char buffer[32];
+  int length = ::snprintf(buffer, sizeof(buffer), "\"0x%08" PRIX64 "\"",
+                          static_cast<uint64_t>(value));
+  output->append(buffer, length);
 }
 
-template <typename IntType>
-void EmitDecValue(IntType value, std::string* output) {
+void EmitDecValue(google::protobuf::int64 value, JsonWriter* output) {
   assert(output != nullptr);
-  std::ostringstream oss;
-  oss << std::dec << std::setw(0) << value;
-  output->append(oss.str());
+  char buffer[32];
+  int length = ::snprintf(buffer, sizeof(buffer), "%" PRId64,
+                          static_cast<int64_t>(value));
+  output->append(buffer, length);
 }
 
-void EmitDouble(double value, std::string* output) {
+void EmitDecValue(google::protobuf::uint64 value, JsonWriter* output) {
   assert(output != nullptr);
-  std::ostringstream oss;
-  oss << std::scientific << std::setprecision(16) << std::uppercase << value;
-  output->append(oss.str());
+  char buffer[32];
+  int length = ::snprintf(buffer, sizeof(buffer), "%" PRIu64,
+                          static_cast<uint64_t>(value));
+  output->append(buffer, length);
 }
 
-void EmitNull(std::string* output) {
+void EmitDouble(double value, JsonWriter* output) {
   assert(output != nullptr);
-  output->append("null");
+  char buffer[64];
+  int length = ::snprintf(buffer, sizeof(buffer), "%.16E", value);
+  output->append(buffer, length);
 }
 
-void EmitString(const std::string& s, std::string* output) {
+void EmitNull(JsonWriter* output) {
+  assert(output != nullptr);
+  output->append("null", 4);
+}
+
+void EmitString(const std::string& s, JsonWriter* output) {
   assert(output != nullptr);
-  output->reserve(output->size() + 2 + s.size());
   output->push_back('"');
+  // Emit runs of characters that need no escaping in one go.
+  size_t run_begin = 0;
   for (size_t i = 0; i < s.size(); ++i) {
-    if (s[i] == '"') {
-      output->append("\\\"");
-    } else if (s[i] == '\\') {
-      output->append("\\\\");
-    } else {
-      output->push_back(s[i]);
+    if (s[i] != '"' && s[i] != '\\')
+      continue;
+    output->append(s.data() + run_begin, i - run_begin);
+    output->push_back('\\');
+    output->push_back(s[i]);
+    run_begin = i + 1;
+  }
+  output->append(s.data() + run_begin, s.size() - run_begin);
+  output->push_back('"');
+}
+
+// Emits binary data as a single string of hex digits. The digits are produced
+// in chunks on the stack.
+void EmitHexString(const std::string& data, JsonWriter* output) {
+  assert(output != nullptr);
+  output->push_back('"');
+  char chunk[1024];
+  size_t chunk_size = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    unsigned char byte = static_cast<unsigned char>(data[i]);
+    chunk[chunk_size++] = kHexDigits[byte >> 4];
+    chunk[chunk_size++] = kHexDigits[byte & 0xF];
+    if (chunk_size == sizeof(chunk)) {
+      output->append(chunk, chunk_size);
+      chunk_size = 0;
     }
   }
+  output->append(chunk, chunk_size);
   output->push_back('"');
 }
 
@@ -111,7 +197,7 @@ bool EmitJsonList(char open_bracket,
                   size_t item_count,
                   YieldFunctor& yield,
                   std::string* indent,
-                  std::string* output) {
+                  JsonWriter* output) {
   assert(items_per_line > 0);
   assert(output != nullptr);
 
@@ -155,7 +241,7 @@ bool EmitJsonList(char open_bracket,
 // for the value.
 void EmitDictKey(const std::string& key,
                  std::string* indent,
-                 std::string* output) {
+                 JsonWriter* output) {
   assert(output != nullptr);
   EmitString(key, output);
   output->push_back(':');
@@ -165,9 +251,9 @@ void EmitDictKey(const std::string& key,
 
 // Forward declaration of this, as it's the common container type for other
 // values.
-bool ToJson(const Value* value, std::string* indent, std::string* output);
+bool ToJson(const Value* value, std::string* indent, JsonWriter* output);
 
-bool ToJson(const Address* address, std::string* indent, std::string* output) {
+bool ToJson(const Address* address, std::string* indent, JsonWriter* output) {
   assert(address != nullptr);
   assert(output != nullptr);
   EmitHexValue32(address->address(), output);
@@ -180,7 +266,7 @@ struct StackTraceYieldFunctor {
     assert(stack_trace != nullptr);
   }
 
-  bool operator()(size_t index, std::string* indent, std::string* output) {
+  bool operator()(size_t index, std::string* indent, JsonWriter* output) {
     assert(output != nullptr);
     assert(index <= std::numeric_limits<int>::max());
     EmitHexValue32(stack_trace_->frames().Get(static_cast<int>(index)), output);
@@ -192,7 +278,7 @@ struct StackTraceYieldFunctor {
 
 bool ToJson(const StackTrace* stack_trace,
             std::string* indent,
-            std::string* output) {
+            JsonWriter* output) {
   assert(stack_trace != nullptr);
   assert(output != nullptr);
   StackTraceYieldFunctor yield(stack_trace);
@@ -210,7 +296,7 @@ struct BlobDataYieldFunctor {
     assert(blob != nullptr);
   }
 
-  bool operator()(size_t index, std::string* indent, std::string* output) {
+  bool operator()(size_t index, std::string* indent, JsonWriter* output) {
     EmitHexValue8(static_cast<unsigned char>(blob_->data()[index]), output);
     return true;
   }
@@ -225,7 +311,7 @@ struct BlobYieldFunctor {
     assert(blob != nullptr);
   }
 
-  bool operator()(size_t index, std::string* indent, std::string* output) {
+  bool operator()(size_t index, std::string* indent, JsonWriter* output) {
     assert(output != nullptr);
     switch (index) {
       case 0: {
@@ -247,7 +333,8 @@ struct BlobYieldFunctor {
       case 2: {
         EmitDictKey("size", indent, output);
         if (blob_->has_size()) {
-          EmitDecValue(blob_->size(), output);
+          EmitDecValue(static_cast<google::protobuf::uint64>(blob_->size()),
+                       output);
         } else {
           EmitNull(output);
         }
@@ -255,7 +342,9 @@ struct BlobYieldFunctor {
       }
       case 3: {
         EmitDictKey("data", indent, output);
-        if (blob_->has_data()) {
+        if (blob_->has_data() && output->options().blob_data_as_hex_string) {
+          EmitHexString(blob_->data(), output);
+        } else if (blob_->has_data()) {
           BlobDataYieldFunctor yield(blob_);
           if (!EmitJsonList('[', ']', 8, blob_->data().size(), yield,
                             indent, output)) {
@@ -278,7 +367,7 @@ struct BlobYieldFunctor {
   bool need_comma_;
 };
 
-bool ToJson(const Blob* blob, std::string* indent, std::string* output) {
+bool ToJson(const Blob* blob, std::string* indent, JsonWriter* output) {
   assert(blob != nullptr);
   assert(output != nullptr);
   BlobYieldFunctor yield(blob);
@@ -288,7 +377,7 @@ bool ToJson(const Blob* blob, std::string* indent, std::string* output) {
   return true;
 }
 
-bool ToJson(const Leaf* leaf, std::string* indent, std::string* output) {
+bool ToJson(const Leaf* leaf, std::string* indent, JsonWriter* output) {
   assert(leaf != nullptr);
   assert(output != nullptr);
 
@@ -361,7 +450,7 @@ bool ToJson(const Leaf* leaf, std::string* indent, std::string* output) {
 struct ValueListYieldFunctor {
   explicit ValueListYieldFunctor(const ValueList* list) : list_(list) {}
 
-  bool operator()(size_t index, std::string* indent, std::string* output) {
+  bool operator()(size_t index, std::string* indent, JsonWriter* output) {
     assert(output != nullptr);
     assert(index <= std::numeric_limits<int>::max());
     if (!ToJson(&list_->values().Get(static_cast<int>(index)), indent, output))
@@ -372,7 +461,7 @@ struct ValueListYieldFunctor {
   const ValueList* list_;
 };
 
-bool ToJson(const ValueList* list, std::string* indent, std::string* output) {
+bool ToJson(const ValueList* list, std::string* indent, JsonWriter* output) {
   assert(list != nullptr);
   assert(output != nullptr);
   ValueListYieldFunctor yield(list);
@@ -382,7 +471,7 @@ bool ToJson(const ValueList* list, std::string* indent, std::string* output) {
 }
 
 bool ToJson(
-    const KeyValue* key_value, std::string* indent, std::string* output) {
+    const KeyValue* key_value, std::string* indent, JsonWriter* output) {
   assert(key_value != nullptr);
   assert(output != nullptr);
   if (!key_value->has_key())
@@ -401,7 +490,7 @@ struct DictYieldFunctor {
 
   bool operator()(size_t index,
                   std::string* indent,
-                  std::string* output) {
+                  JsonWriter* output) {
     assert(output != nullptr);
     assert(index <= std::numeric_limits<int>::max());
     if (!ToJson(&dict_->values().Get(static_cast<int>(index)), indent, output))
@@ -412,7 +501,7 @@ struct DictYieldFunctor {
   const Dictionary* dict_;
 };
 
-bool ToJson(const Dictionary* dict, std::string* indent, std::string* output) {
+bool ToJson(const Dictionary* dict, std::string* indent, JsonWriter* output) {
   assert(dict != nullptr);
   assert(output != nullptr);
   DictYieldFunctor yield(dict);
@@ -421,7 +510,7 @@ bool ToJson(const Dictionary* dict, std::string* indent, std::string* output) {
   return true;
 }
 
-bool ToJson(const Value* value, std::string* indent, std::string* output) {
+bool ToJson(const Value* value, std::string* indent, JsonWriter* output) {
   assert(value != nullptr);
   assert(output != nullptr);
   if (!value->has_type())
@@ -463,20 +552,36 @@ bool ToJson(const Value* value, std::string* indent, std::string* output) {
 
 }  // namespace
 
+StringJsonSink::StringJsonSink(std::string* output) : output_(output) {
+  assert(output != nullptr);
+}
+
+bool StringJsonSink::Write(const char* data, size_t length) {
+  output_->append(data, length);
+  return true;
+}
+
+FileJsonSink::FileJsonSink(FILE* file) : file_(file) {
+  assert(file != nullptr);
+}
+
+bool FileJsonSink::Write(const char* data, size_t length) {
+  return ::fwrite(data, 1, length, file_) == length;
+}
+
 bool ToJson(bool pretty_print, const Value* value, std::string* output) {
   assert(value != nullptr);
   assert(output != nullptr);
-  std::string* indent = nullptr;
-  std::string indent_content;
-  if (pretty_print) {
-    indent_content = "\n";
-    indent = &indent_content;
-  }
 
   // Produce the output to a temp variable, as partial output may be produced
-  // in case of error.
+  // in case of error. The serialized size of the value is a lower bound on
+  // the size of its JSON representation.
   std::string temp;
-  if (!ToJson(value, indent, &temp))
+  temp.reserve(value->ByteSize());
+  StringJsonSink sink(&temp);
+  JsonOptions options;
+  options.pretty_print = pretty_print;
+  if (!ToJson(options, value, &sink))
     return false;
 
   // Place the output in the desired string as efficiently as possible.
@@ -489,4 +594,20 @@ bool ToJson(bool pretty_print, const Value* value, std::string* output) {
   return true;
 }
 
+bool ToJson(const JsonOptions& options, const Value* value, JsonSink* sink) {
+  assert(value != nullptr);
+  assert(sink != nullptr);
+  std::string* indent = nullptr;
+  std::string indent_content;
+  if (options.pretty_print) {
+    indent_content = "\n";
+    indent = &indent_content;
+  }
+
+  JsonWriter writer(options, sink);
+  if (!ToJson(value, indent, &writer))
+    return false;
+  return writer.Flush();
+}
+
 }  // namespace crashdata
@@ -20,8 +20,63 @@
 
 #include "syzygy/crashdata/crashdata.h"
 
+#include <stdio.h>
+
+#include <string>
+
 namespace crashdata {
 
+// A destination for JSON output. The output is handed to the sink in chunks
+// as it is produced, so a value need not be converted in memory as a whole.
+class JsonSink {
+ public:
+  virtual ~JsonSink() {}
+
+  // Appends a chunk of output.
+  // @param data The output to append.
+  // @param length The length of @p data.
+  // @returns true on success, false otherwise.
+  virtual bool Write(const char* data, size_t length) = 0;
+};
+
+// A sink that appends the output to a string.
+class StringJsonSink : public JsonSink {
+ public:
+  // @param output The string to append to. Must outlive this object.
+  explicit StringJsonSink(std::string* output);
+
+  // JsonSink implementation.
+  bool Write(const char* data, size_t length) override;
+
+ private:
+  std::string* output_;
+};
+
+// A sink that writes the output to a file.
+class FileJsonSink : public JsonSink {
+ public:
+  // @param file The file to write to. Must outlive this object.
+  explicit FileJsonSink(FILE* file);
+
+  // JsonSink implementation.
+  bool Write(const char* data, size_t length) override;
+
+ private:
+  FILE* file_;
+};
+
+// Options controlling the JSON representation of crash metadata.
+struct JsonOptions {
+  JsonOptions() : pretty_print(false), blob_data_as_hex_string(false) {}
+
+  // If true the resulting JSON will be pretty-printed.
+  bool pretty_print;
+  // If true the data of blobs is emitted as a single string of hex digits,
+  // rather than as a list of hex byte strings. This is several times more
+  // compact for large blobs.
+  bool blob_data_as_hex_string;
+};
+
 // Converts the provided crashdata protobuf to an equivalent JSON
 // representation.
 // @param pretty_print If true the resulting JSON will be pretty-printed.
@@ -30,6 +85,15 @@ namespace crashdata {
 // @returns true on success, false otherwise.
 bool ToJson(bool pretty_print, const Value* value, std::string* output);
 
+// Converts the provided crashdata protobuf to an equivalent JSON
+// representation, streaming it to a sink.
+// @param options The options controlling the representation.
+// @param value A value object containing crash metadata.
+// @param sink The destination of the output. Partial output may have been
+//     written to it on failure.
+// @returns true on success, false otherwise.
+bool ToJson(const JsonOptions& options, const Value* value, JsonSink* sink);
+
 }  // namespace crashdata
 
 #endif  // SYZYGY_CRASHDATA_JSON_H_
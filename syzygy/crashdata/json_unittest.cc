@@ -14,6 +14,9 @@
 
 #include "syzygy/crashdata/json.h"
 
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 namespace crashdata {
@@ -291,4 +294,78 @@ TEST(CrashDataJsonTest, AllTypes) {
   TestConversion(false, value, kExpectedCompact);
 }
 
+TEST(CrashDataJsonTest, BlobDataAsHexString) {
+  Value value;
+  Blob* blob = LeafGetBlob(ValueGetLeaf(&value));
+  blob->set_size(4);
+  blob->mutable_data()->append("\xDE\xAD\x0F\x00", 4);
+
+  JsonOptions options;
+  options.blob_data_as_hex_string = true;
+  std::string json;
+  StringJsonSink sink(&json);
+  EXPECT_TRUE(ToJson(options, &value, &sink));
+  EXPECT_EQ("{\"type\":\"blob\",\"address\":null,\"size\":4,"
+            "\"data\":\"DEAD0F00\"}",
+            json);
+}
+
+TEST(CrashDataJsonTest, LargeOutputIsStreamedInChunks) {
+  // A string sink that records the size of each chunk it receives.
+  class RecordingSink : public JsonSink {
+   public:
+    bool Write(const char* data, size_t length) override {
+      output.append(data, length);
+      chunk_sizes.push_back(length);
+      return true;
+    }
+
+    std::string output;
+    std::vector<size_t> chunk_sizes;
+  };
+
+  // A blob large enough to span several chunks, with string escapes.
+  Value value;
+  value.set_type(Value_Type_DICTIONARY);
+  Dictionary* dict = value.mutable_dictionary();
+  std::string* data =
+      LeafGetBlob(ValueGetLeaf(DictAddValue("blob", dict)))->mutable_data();
+  for (size_t i = 0; i < 200000; ++i)
+    data->push_back(static_cast<char>(i));
+  *LeafGetString(ValueGetLeaf(DictAddValue("string", dict))) =
+      std::string(100000, '"');
+
+  for (int hex_string = 0; hex_string < 2; ++hex_string) {
+    for (int pretty_print = 0; pretty_print < 2; ++pretty_print) {
+      JsonOptions options;
+      options.pretty_print = pretty_print != 0;
+      options.blob_data_as_hex_string = hex_string != 0;
+      RecordingSink sink;
+      EXPECT_TRUE(ToJson(options, &value, &sink));
+      EXPECT_LT(1u, sink.chunk_sizes.size());
+
+      if (!options.blob_data_as_hex_string) {
+        // The streamed output matches the output produced in one piece.
+        std::string json;
+        EXPECT_TRUE(ToJson(options.pretty_print, &value, &json));
+        EXPECT_EQ(json, sink.output);
+      } else {
+        EXPECT_NE(std::string::npos, sink.output.find("000102030405"));
+      }
+    }
+  }
+}
+
+TEST(CrashDataJsonTest, FailingSinkFails) {
+  class FailingSink : public JsonSink {
+   public:
+    bool Write(const char* data, size_t length) override { return false; }
+  };
+
+  Value value;
+  LeafSetInt(42, ValueGetLeaf(&value));
+  FailingSink sink;
+  EXPECT_FALSE(ToJson(JsonOptions(), &value, &sink));
+}
+
 }  // namespace crashdata
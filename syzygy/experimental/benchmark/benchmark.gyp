@@ -0,0 +1,76 @@
+# Copyright 2016 Google Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+{
+  'variables': {
+    'chromium_code': 1,
+  },
+  'targets': [
+    {
+      'target_name': 'toolchain_benchmark_lib',
+      'type': 'static_library',
+      'sources': [
+        'toolchain_benchmark_app.cc',
+        'toolchain_benchmark_app.h',
+      ],
+      'dependencies': [
+        '<(src)/base/base.gyp:base',
+        '<(src)/syzygy/application/application.gyp:application_lib',
+        '<(src)/syzygy/testing/testing.gyp:testing_lib',
+      ],
+      'libraries': [
+        'psapi.lib',
+      ],
+    },
+    {
+      'target_name': 'toolchain_benchmark',
+      'type': 'executable',
+      'sources': [
+        'toolchain_benchmark_main.cc',
+      ],
+      'dependencies': [
+        'toolchain_benchmark_lib',
+        # The toolchain being benchmarked, and the image it's run on by
+        # default.
+        '<(src)/syzygy/instrument/instrument.gyp:instrument',
+        '<(src)/syzygy/optimize/optimize.gyp:optimize',
+        '<(src)/syzygy/pe/pe.gyp:decompose',
+        '<(src)/syzygy/pe/pe.gyp:test_dll',
+        '<(src)/syzygy/relink/relink.gyp:relink',
+      ],
+      'run_as': {
+        'action': [
+          '$(TargetPath)',
+          '--iterations=3',
+          '$(OutDir)\\test_dll.dll',
+        ],
+      },
+    },
+    {
+      'target_name': 'toolchain_benchmark_unittests',
+      'type': 'executable',
+      'sources': [
+        'toolchain_benchmark_app_unittest.cc',
+        '<(src)/syzygy/testing/run_all_unittests.cc',
+      ],
+      'dependencies': [
+        'toolchain_benchmark_lib',
+        '<(src)/base/base.gyp:base',
+        '<(src)/base/base.gyp:test_support_base',
+        '<(src)/testing/gmock.gyp:gmock',
+        '<(src)/testing/gtest.gyp:gtest',
+      ],
+    },
+  ],
+}
@@ -0,0 +1,444 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/experimental/benchmark/toolchain_benchmark_app.h"
+
+#include <windows.h>  // NOLINT
+#include <psapi.h>
+
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+#include "base/environment.h"
+#include "base/path_service.h"
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/json/json_reader.h"
+#include "base/process/launch.h"
+#include "base/process/process.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/strings/stringprintf.h"
+#include "base/strings/utf_string_conversions.h"
+#include "base/time/time.h"
+#include "base/values.h"
+#include "syzygy/testing/metrics.h"
+
+namespace experimental {
+
+namespace {
+
+const char kUsageFormatStr[] =
+    "Usage: %ls [options] [IMAGE ...]\n"
+    "\n"
+    "  A tool that runs the toolchain end to end on the given images, and\n"
+    "  records the wall time, peak memory and output sizes of each stage as\n"
+    "  metrics. The metrics are appended to metrics.csv alongside this\n"
+    "  executable. If no image is given, test_dll.dll from the tool\n"
+    "  directory is used.\n"
+    "\n"
+    "  The stages are: decompose, relink, asan, bbentry, coverage, profile\n"
+    "  and optimize. The time taken to write the PDB is reported as the\n"
+    "  write_pdb phase of the stages that rewrite the image.\n"
+    "\n"
+    "Optional parameters:\n"
+    "  --iterations=NUM     The number of times to run each stage. The\n"
+    "                       default is 3.\n"
+    "  --stages=LIST        A comma separated list of the stages to run.\n"
+    "                       Defaults to all of them.\n"
+    "  --tool-dir=DIR       The directory containing the toolchain\n"
+    "                       executables. Defaults to the directory of this\n"
+    "                       executable.\n"
+    "  --work-dir=DIR       The directory to write the outputs to. Defaults\n"
+    "                       to a temporary directory, deleted on exit.\n";
+
+// The environment variable controlling testing::EmitMetric, and the option
+// causing the metrics to be written to metrics.csv.
+const char kMetricsEnvVar[] = "SYZYGY_UNITTEST_METRICS";
+const char kEmitToLog[] = "--emit-to-log";
+
+// The image benchmarked by default.
+const wchar_t kDefaultImage[] = L"test_dll.dll";
+
+const int kDefaultIterations = 3;
+
+// The keys of the phase profiles written by core::PhaseProfiler.
+const char kPhaseNameKey[] = "name";
+const char kPhaseWallTimeKey[] = "wall_time";
+const char kPhasePhasesKey[] = "phases";
+
+// Reads a list of phases, recursing into the nested phases.
+bool ReadPhaseList(const base::ListValue& phases,
+                   const std::string& prefix,
+                   std::map<std::string, double>* phase_times_ms) {
+  for (size_t i = 0; i < phases.GetSize(); ++i) {
+    const base::DictionaryValue* phase = NULL;
+    std::string name;
+    double wall_time = 0;
+    if (!phases.GetDictionary(i, &phase) ||
+        !phase->GetString(kPhaseNameKey, &name) ||
+        !phase->GetDouble(kPhaseWallTimeKey, &wall_time)) {
+      LOG(ERROR) << "Invalid phase in phase profile.";
+      return false;
+    }
+
+    std::string path = prefix + ToolchainBenchmarkApp::ToMetricName(name);
+    double wall_time_ms = wall_time * 1000.0;
+    std::map<std::string, double>::iterator it =
+        phase_times_ms->insert(std::make_pair(path, wall_time_ms)).first;
+    it->second = std::min(it->second, wall_time_ms);
+
+    const base::ListValue* children = NULL;
+    if (phase->GetList(kPhasePhasesKey, &children) &&
+        !ReadPhaseList(*children, path + ".", phase_times_ms)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double Median(std::vector<double> values) {
+  DCHECK(!values.empty());
+  std::sort(values.begin(), values.end());
+  size_t middle = values.size() / 2;
+  if (values.size() % 2 == 1)
+    return values[middle];
+  return (values[middle - 1] + values[middle]) / 2;
+}
+
+}  // namespace
+
+const ToolchainBenchmarkApp::Stage ToolchainBenchmarkApp::kStages[] = {
+    { "decompose", L"decompose.exe", NULL, false },
+    { "relink", L"relink.exe", NULL, true },
+    { "asan", L"instrument.exe", "asan", true },
+    { "bbentry", L"instrument.exe", "bbentry", true },
+    { "coverage", L"instrument.exe", "coverage", true },
+    { "profile", L"instrument.exe", "profile", true },
+    { "optimize", L"optimize.exe", NULL, true },
+};
+
+const size_t ToolchainBenchmarkApp::kStageCount = arraysize(kStages);
+
+ToolchainBenchmarkApp::StageResult::StageResult()
+    : peak_working_set(0), output_image_size(0), output_pdb_size(0) {
+}
+
+ToolchainBenchmarkApp::ToolchainBenchmarkApp()
+    : application::AppImplBase("Toolchain Benchmark"),
+      num_iterations_(kDefaultIterations) {
+}
+
+void ToolchainBenchmarkApp::PrintUsage(const base::FilePath& program,
+                                       const base::StringPiece& message) {
+  if (!message.empty()) {
+    ::fwrite(message.data(), 1, message.length(), out());
+    ::fprintf(out(), "\n\n");
+  }
+
+  ::fprintf(out(), kUsageFormatStr, program.BaseName().value().c_str());
+}
+
+bool ToolchainBenchmarkApp::ParseCommandLine(
+    const base::CommandLine* cmd_line) {
+  DCHECK(cmd_line != NULL);
+
+  if (cmd_line->HasSwitch("help")) {
+    PrintUsage(cmd_line->GetProgram(), "");
+    return false;
+  }
+
+  if (cmd_line->HasSwitch("iterations") &&
+      (!base::StringToInt(cmd_line->GetSwitchValueASCII("iterations"),
+                          &num_iterations_) ||
+       num_iterations_ <= 0)) {
+    PrintUsage(cmd_line->GetProgram(), "Must specify '--iterations' >= 1!");
+    return false;
+  }
+
+  stages_.clear();
+  if (cmd_line->HasSwitch("stages")) {
+    for (const std::string& name : base::SplitString(
+             cmd_line->GetSwitchValueASCII("stages"), ",",
+             base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+      const Stage* stage = NULL;
+      for (size_t i = 0; i < kStageCount; ++i) {
+        if (name == kStages[i].name)
+          stage = &kStages[i];
+      }
+      if (stage == NULL) {
+        PrintUsage(cmd_line->GetProgram(), "Unknown stage: " + name);
+        return false;
+      }
+      stages_.push_back(stage);
+    }
+  } else {
+    for (size_t i = 0; i < kStageCount; ++i)
+      stages_.push_back(&kStages[i]);
+  }
+  if (stages_.empty()) {
+    PrintUsage(cmd_line->GetProgram(), "Must specify at least one stage!");
+    return false;
+  }
+
+  tool_dir_ = AbsolutePath(cmd_line->GetSwitchValuePath("tool-dir"));
+  if (tool_dir_.empty() && !PathService::Get(base::DIR_EXE, &tool_dir_)) {
+    LOG(ERROR) << "Unable to determine the tool directory.";
+    return false;
+  }
+  work_dir_ = AbsolutePath(cmd_line->GetSwitchValuePath("work-dir"));
+
+  images_.clear();
+  for (const base::CommandLine::StringType& arg : cmd_line->GetArgs())
+    images_.push_back(AbsolutePath(base::FilePath(arg)));
+  if (images_.empty())
+    images_.push_back(tool_dir_.Append(kDefaultImage));
+
+  return true;
+}
+
+int ToolchainBenchmarkApp::Run() {
+  DCHECK(!images_.empty());
+  DCHECK(!stages_.empty());
+  DCHECK_LT(0, num_iterations_);
+
+  // Have the metrics written to metrics.csv, unless configured otherwise.
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  if (!env->HasVar(kMetricsEnvVar))
+    env->SetVar(kMetricsEnvVar, kEmitToLog);
+
+  base::ScopedTempDir temp_dir;
+  base::FilePath work_dir = work_dir_;
+  if (work_dir.empty()) {
+    if (!temp_dir.CreateUniqueTempDir()) {
+      LOG(ERROR) << "Unable to create a temporary directory.";
+      return 1;
+    }
+    work_dir = temp_dir.path();
+  } else if (!base::CreateDirectory(work_dir)) {
+    LOG(ERROR) << "Unable to create " << work_dir.value() << ".";
+    return 1;
+  }
+
+  for (const base::FilePath& image : images_) {
+    LOG(INFO) << "Benchmarking \"" << image.value() << "\".";
+    for (const Stage* stage : stages_) {
+      StageResult result;
+      if (!RunStage(*stage, image, work_dir, &result))
+        return 1;
+      EmitStageMetrics(image, *stage, result);
+    }
+  }
+
+  return 0;
+}
+
+base::CommandLine ToolchainBenchmarkApp::BuildStageCommandLine(
+    const Stage& stage,
+    const base::FilePath& input_image,
+    const base::FilePath& output_path,
+    const base::FilePath& output_pdb,
+    const base::FilePath& phase_profile) const {
+  base::CommandLine command_line(tool_dir_.Append(stage.tool));
+  if (!stage.rewrites_image) {
+    command_line.AppendSwitchPath("image", input_image);
+    command_line.AppendSwitchPath("output", output_path);
+    return command_line;
+  }
+
+  command_line.AppendSwitchPath("input-image", input_image);
+  command_line.AppendSwitchPath("output-image", output_path);
+  command_line.AppendSwitchPath("output-pdb", output_pdb);
+  command_line.AppendSwitchPath("phase-profile", phase_profile);
+  command_line.AppendSwitch("overwrite");
+  if (stage.mode != NULL)
+    command_line.AppendSwitchASCII("mode", stage.mode);
+
+  // Without profile data the optimizer only runs the transforms that don't
+  // need it.
+  if (::strcmp(stage.name, "optimize") == 0) {
+    command_line.AppendSwitch("inlining");
+    command_line.AppendSwitch("peephole");
+    command_line.AppendSwitch("unreachable-block");
+  }
+  return command_line;
+}
+
+bool ToolchainBenchmarkApp::ReadPhaseProfile(
+    const base::FilePath& path,
+    std::map<std::string, double>* phase_times_ms) {
+  DCHECK(phase_times_ms != NULL);
+
+  std::string contents;
+  if (!base::ReadFileToString(path, &contents)) {
+    LOG(ERROR) << "Unable to read phase profile: " << path.value();
+    return false;
+  }
+
+  const base::ListValue* phases = NULL;
+  std::unique_ptr<base::Value> value(
+      base::JSONReader::Read(contents).release());
+  if (value.get() == NULL || !value->GetAsList(&phases)) {
+    LOG(ERROR) << "Phase profile does not contain a valid JSON list: "
+               << path.value();
+    return false;
+  }
+
+  return ReadPhaseList(*phases, "", phase_times_ms);
+}
+
+std::string ToolchainBenchmarkApp::ToMetricName(const std::string& name) {
+  std::string metric_name(name);
+  for (size_t i = 0; i < metric_name.size(); ++i) {
+    char c = metric_name[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '_')) {
+      metric_name[i] = '_';
+    }
+  }
+  return metric_name;
+}
+
+bool ToolchainBenchmarkApp::RunStage(const Stage& stage,
+                                     const base::FilePath& image,
+                                     const base::FilePath& work_dir,
+                                     StageResult* result) {
+  DCHECK(result != NULL);
+
+  base::FilePath base_name = image.BaseName().RemoveExtension();
+  base::FilePath stage_base = work_dir.Append(
+      base_name.value() + L"." + base::ASCIIToUTF16(stage.name));
+  base::FilePath output_path = stage.rewrites_image ?
+      stage_base.AddExtension(image.Extension()) :
+      stage_base.AddExtension(L"bg");
+  base::FilePath output_pdb = stage_base.AddExtension(L"pdb");
+  base::FilePath phase_profile = stage_base.AddExtension(L"json");
+
+  base::CommandLine command_line = BuildStageCommandLine(
+      stage, image, output_path, output_pdb, phase_profile);
+
+  for (int i = 0; i < num_iterations_; ++i) {
+    LOG(INFO) << "Running " << stage.name << ", iteration " << (i + 1)
+              << " of " << num_iterations_ << ".";
+
+    // Remove the output of the previous iteration, so that its size can't be
+    // mistaken for that of this one.
+    base::DeleteFile(output_path, false);
+
+    double wall_time_ms = 0;
+    uint64_t peak_working_set = 0;
+    if (!RunProcess(command_line, &wall_time_ms, &peak_working_set))
+      return false;
+    result->wall_times_ms.push_back(wall_time_ms);
+    result->peak_working_set =
+        std::max(result->peak_working_set, peak_working_set);
+
+    if (stage.rewrites_image &&
+        !ReadPhaseProfile(phase_profile, &result->phase_times_ms)) {
+      return false;
+    }
+  }
+
+  if (!base::GetFileSize(output_path, &result->output_image_size)) {
+    LOG(ERROR) << "Unable to get the size of " << output_path.value() << ".";
+    return false;
+  }
+  if (stage.rewrites_image &&
+      !base::GetFileSize(output_pdb, &result->output_pdb_size)) {
+    LOG(ERROR) << "Unable to get the size of " << output_pdb.value() << ".";
+    return false;
+  }
+
+  return true;
+}
+
+bool ToolchainBenchmarkApp::RunProcess(const base::CommandLine& command_line,
+                                       double* wall_time_ms,
+                                       uint64_t* peak_working_set) {
+  DCHECK(wall_time_ms != NULL);
+  DCHECK(peak_working_set != NULL);
+
+  VLOG(1) << "Command Line: " << command_line.GetCommandLineString();
+
+  base::LaunchOptions options;
+  options.start_hidden = true;
+  base::TimeTicks start = base::TimeTicks::Now();
+  base::Process process = base::LaunchProcess(command_line, options);
+  if (!process.IsValid()) {
+    LOG(ERROR) << "Failed to launch '" << command_line.GetProgram().value()
+               << "'.";
+    return false;
+  }
+
+  int exit_code = 0;
+  if (!process.WaitForExit(&exit_code)) {
+    LOG(ERROR) << "Failed to wait for '" << command_line.GetProgram().value()
+               << "'.";
+    return false;
+  }
+  *wall_time_ms = (base::TimeTicks::Now() - start).InMillisecondsF();
+
+  if (exit_code != 0) {
+    LOG(ERROR) << "'" << command_line.GetProgram().value()
+               << "' failed with exit code " << exit_code << ".";
+    return false;
+  }
+
+  // The counters of a process remain available until its last handle is
+  // closed.
+  PROCESS_MEMORY_COUNTERS counters = {};
+  if (!::GetProcessMemoryInfo(process.Handle(), &counters,
+                              sizeof(counters))) {
+    LOG(ERROR) << "Unable to get the memory counters of '"
+               << command_line.GetProgram().value() << "'.";
+    return false;
+  }
+  *peak_working_set = counters.PeakWorkingSetSize;
+
+  return true;
+}
+
+void ToolchainBenchmarkApp::EmitStageMetrics(const base::FilePath& image,
+                                             const Stage& stage,
+                                             const StageResult& result) {
+  DCHECK(!result.wall_times_ms.empty());
+
+  // Metrics are named Syzygy.Benchmark.<image>.<stage>.<metric>.
+  std::string prefix = base::StringPrintf(
+      "Syzygy.Benchmark.%s.%s.",
+      ToMetricName(base::UTF16ToUTF8(
+          image.BaseName().RemoveExtension().value())).c_str(),
+      stage.name);
+
+  testing::EmitMetric(
+      prefix + "WallTimeMs.Min",
+      *std::min_element(result.wall_times_ms.begin(),
+                        result.wall_times_ms.end()));
+  testing::EmitMetric(prefix + "WallTimeMs.Median",
+                      Median(result.wall_times_ms));
+  testing::EmitMetric(prefix + "PeakWorkingSetBytes",
+                      result.peak_working_set);
+  testing::EmitMetric(prefix + "OutputBytes", result.output_image_size);
+  if (stage.rewrites_image)
+    testing::EmitMetric(prefix + "OutputPdbBytes", result.output_pdb_size);
+
+  std::map<std::string, double>::const_iterator it =
+      result.phase_times_ms.begin();
+  for (; it != result.phase_times_ms.end(); ++it)
+    testing::EmitMetric(prefix + "Phase." + it->first + ".WallTimeMs",
+                        it->second);
+}
+
+}  // namespace experimental
@@ -0,0 +1,155 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A command line application that runs the toolchain end to end on a set of
+// images and records the time, memory and output sizes of each stage as
+// metrics.
+
+#ifndef SYZYGY_EXPERIMENTAL_BENCHMARK_TOOLCHAIN_BENCHMARK_APP_H_
+#define SYZYGY_EXPERIMENTAL_BENCHMARK_TOOLCHAIN_BENCHMARK_APP_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/command_line.h"
+#include "base/files/file_path.h"
+#include "syzygy/application/application.h"
+
+namespace experimental {
+
+// This class implements the toolchain_benchmark command-line utility.
+//
+// Each stage runs one of the toolchain executables in a child process, so
+// that its peak memory use is its own. The metrics are emitted with
+// testing::EmitMetric, which appends them to metrics.csv alongside this
+// executable along with the version, git hash and build configuration, so
+// that they can be tracked across commits.
+//
+// See the description given in ToolchainBenchmarkApp::PrintUsage() for
+// information about running this utility.
+class ToolchainBenchmarkApp : public application::AppImplBase {
+ public:
+  // A stage of the toolchain.
+  struct Stage {
+    // The name of the stage, as used in metric names and on the command line.
+    const char* name;
+    // The executable running the stage.
+    const wchar_t* tool;
+    // The instrumentation mode, for instrument.exe.
+    const char* mode;
+    // Whether the stage rewrites the image, producing an image and a PDB.
+    bool rewrites_image;
+  };
+
+  // The stages, in the order they run.
+  static const Stage kStages[];
+  static const size_t kStageCount;
+
+  // The measurements of a stage, over all iterations.
+  struct StageResult {
+    StageResult();
+
+    // The wall time of each iteration, in milliseconds.
+    std::vector<double> wall_times_ms;
+    // The largest peak working set of the child process, in bytes.
+    uint64_t peak_working_set;
+    // The size of the outputs of the last iteration, in bytes.
+    int64_t output_image_size;
+    int64_t output_pdb_size;
+    // The shortest wall time of each phase reported by the tool, in
+    // milliseconds, keyed by the dotted path of the phase.
+    std::map<std::string, double> phase_times_ms;
+  };
+
+  ToolchainBenchmarkApp();
+
+  // @name Implementation of the AppImplBase interface.
+  // @{
+  bool ParseCommandLine(const base::CommandLine* command_line);
+
+  int Run();
+  // @}
+
+  // Builds the command line running @p stage.
+  // @param stage The stage to run.
+  // @param input_image The image to process.
+  // @param output_path The output of the stage: an image, or the serialized
+  //     decomposition for the decompose stage.
+  // @param output_pdb The output PDB, if the stage rewrites the image.
+  // @param phase_profile The path to write the phase profile to, if the stage
+  //     rewrites the image.
+  // @returns the command line.
+  base::CommandLine BuildStageCommandLine(
+      const Stage& stage,
+      const base::FilePath& input_image,
+      const base::FilePath& output_path,
+      const base::FilePath& output_pdb,
+      const base::FilePath& phase_profile) const;
+
+  // Reads the wall time of each phase from a phase profile written by
+  // core::PhaseProfiler, keeping the shortest time seen for each.
+  // @param path The path of the phase profile.
+  // @param phase_times_ms The phase times to update, keyed by the dotted path
+  //     of the phase.
+  // @returns true on success, false otherwise.
+  static bool ReadPhaseProfile(const base::FilePath& path,
+                               std::map<std::string, double>* phase_times_ms);
+
+  // Turns @p name into a metric name component, by replacing anything but
+  // alpha-numeric characters and underscores.
+  static std::string ToMetricName(const std::string& name);
+
+ protected:
+  // Print the app's usage information.
+  void PrintUsage(const base::FilePath& program,
+                  const base::StringPiece& message);
+
+  // Runs every iteration of @p stage on @p image.
+  // @returns true on success, false otherwise.
+  bool RunStage(const Stage& stage,
+                const base::FilePath& image,
+                const base::FilePath& work_dir,
+                StageResult* result);
+
+  // Runs a command line to completion in a child process.
+  // @param command_line The command line to run.
+  // @param wall_time_ms Receives the wall time of the process.
+  // @param peak_working_set Receives the peak working set of the process.
+  // @returns true if the process ran and succeeded, false otherwise.
+  bool RunProcess(const base::CommandLine& command_line,
+                  double* wall_time_ms,
+                  uint64_t* peak_working_set);
+
+  // Emits the metrics of @p stage run on @p image.
+  void EmitStageMetrics(const base::FilePath& image,
+                        const Stage& stage,
+                        const StageResult& result);
+
+  // @name Command-line options.
+  // @{
+  std::vector<base::FilePath> images_;
+  std::vector<const Stage*> stages_;
+  base::FilePath tool_dir_;
+  base::FilePath work_dir_;
+  int num_iterations_;
+  // @}
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ToolchainBenchmarkApp);
+};
+
+}  // namespace experimental
+
+#endif  // SYZYGY_EXPERIMENTAL_BENCHMARK_TOOLCHAIN_BENCHMARK_APP_H_
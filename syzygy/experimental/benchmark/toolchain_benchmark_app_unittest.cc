@@ -0,0 +1,180 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/experimental/benchmark/toolchain_benchmark_app.h"
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "gtest/gtest.h"
+
+namespace experimental {
+
+namespace {
+
+class TestToolchainBenchmarkApp : public ToolchainBenchmarkApp {
+ public:
+  using ToolchainBenchmarkApp::images_;
+  using ToolchainBenchmarkApp::num_iterations_;
+  using ToolchainBenchmarkApp::stages_;
+  using ToolchainBenchmarkApp::tool_dir_;
+  using ToolchainBenchmarkApp::work_dir_;
+};
+
+class ToolchainBenchmarkAppTest : public testing::Test {
+ public:
+  ToolchainBenchmarkAppTest()
+      : cmd_line_(base::FilePath(L"toolchain_benchmark.exe")),
+        tool_dir_(L"C:\\tools") {
+  }
+
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+
+    // Usage errors would otherwise clutter the unittest output.
+    app_.set_out(base::OpenFile(base::FilePath(L"NUL"), "wb"));
+  }
+
+  void TearDown() override {
+    base::CloseFile(app_.out());
+  }
+
+  // Returns the stage named @p name.
+  const ToolchainBenchmarkApp::Stage& GetStage(const std::string& name) {
+    for (size_t i = 0; i < ToolchainBenchmarkApp::kStageCount; ++i) {
+      if (name == ToolchainBenchmarkApp::kStages[i].name)
+        return ToolchainBenchmarkApp::kStages[i];
+    }
+    ADD_FAILURE() << "No stage named " << name << ".";
+    return ToolchainBenchmarkApp::kStages[0];
+  }
+
+  base::CommandLine cmd_line_;
+  base::FilePath tool_dir_;
+  base::ScopedTempDir temp_dir_;
+  TestToolchainBenchmarkApp app_;
+};
+
+}  // namespace
+
+TEST_F(ToolchainBenchmarkAppTest, ParseEmptyCommandLine) {
+  ASSERT_TRUE(app_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(ToolchainBenchmarkApp::kStageCount, app_.stages_.size());
+  EXPECT_EQ(3, app_.num_iterations_);
+  ASSERT_EQ(1u, app_.images_.size());
+  EXPECT_EQ(L"test_dll.dll", app_.images_[0].BaseName().value());
+  EXPECT_TRUE(app_.work_dir_.empty());
+}
+
+TEST_F(ToolchainBenchmarkAppTest, ParseFullCommandLine) {
+  cmd_line_.AppendSwitchASCII("iterations", "5");
+  cmd_line_.AppendSwitchASCII("stages", "relink, asan");
+  cmd_line_.AppendSwitchPath("tool-dir", tool_dir_);
+  cmd_line_.AppendSwitchPath("work-dir", temp_dir_.path());
+  cmd_line_.AppendArgPath(base::FilePath(L"C:\\images\\chrome.dll"));
+  cmd_line_.AppendArgPath(base::FilePath(L"C:\\images\\chrome_child.dll"));
+
+  ASSERT_TRUE(app_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(5, app_.num_iterations_);
+  ASSERT_EQ(2u, app_.stages_.size());
+  EXPECT_STREQ("relink", app_.stages_[0]->name);
+  EXPECT_STREQ("asan", app_.stages_[1]->name);
+  EXPECT_EQ(tool_dir_, app_.tool_dir_);
+  EXPECT_EQ(temp_dir_.path(), app_.work_dir_);
+  ASSERT_EQ(2u, app_.images_.size());
+  EXPECT_EQ(L"chrome.dll", app_.images_[0].BaseName().value());
+  EXPECT_EQ(L"chrome_child.dll", app_.images_[1].BaseName().value());
+}
+
+TEST_F(ToolchainBenchmarkAppTest, ParseInvalidCommandLines) {
+  base::CommandLine help(cmd_line_);
+  help.AppendSwitch("help");
+  EXPECT_FALSE(app_.ParseCommandLine(&help));
+
+  base::CommandLine iterations(cmd_line_);
+  iterations.AppendSwitchASCII("iterations", "0");
+  EXPECT_FALSE(app_.ParseCommandLine(&iterations));
+
+  base::CommandLine unknown_stage(cmd_line_);
+  unknown_stage.AppendSwitchASCII("stages", "relink,link");
+  EXPECT_FALSE(app_.ParseCommandLine(&unknown_stage));
+
+  base::CommandLine no_stage(cmd_line_);
+  no_stage.AppendSwitchASCII("stages", ",");
+  EXPECT_FALSE(app_.ParseCommandLine(&no_stage));
+}
+
+TEST_F(ToolchainBenchmarkAppTest, BuildStageCommandLine) {
+  app_.tool_dir_ = tool_dir_;
+  base::FilePath image(L"C:\\images\\test_dll.dll");
+  base::FilePath output(L"C:\\work\\out.dll");
+  base::FilePath pdb(L"C:\\work\\out.pdb");
+  base::FilePath profile(L"C:\\work\\out.json");
+
+  base::CommandLine decompose = app_.BuildStageCommandLine(
+      GetStage("decompose"), image, output, pdb, profile);
+  EXPECT_EQ(tool_dir_.Append(L"decompose.exe"), decompose.GetProgram());
+  EXPECT_EQ(image, decompose.GetSwitchValuePath("image"));
+  EXPECT_EQ(output, decompose.GetSwitchValuePath("output"));
+  EXPECT_FALSE(decompose.HasSwitch("phase-profile"));
+
+  base::CommandLine asan = app_.BuildStageCommandLine(
+      GetStage("asan"), image, output, pdb, profile);
+  EXPECT_EQ(tool_dir_.Append(L"instrument.exe"), asan.GetProgram());
+  EXPECT_EQ("asan", asan.GetSwitchValueASCII("mode"));
+  EXPECT_EQ(image, asan.GetSwitchValuePath("input-image"));
+  EXPECT_EQ(output, asan.GetSwitchValuePath("output-image"));
+  EXPECT_EQ(pdb, asan.GetSwitchValuePath("output-pdb"));
+  EXPECT_EQ(profile, asan.GetSwitchValuePath("phase-profile"));
+  EXPECT_TRUE(asan.HasSwitch("overwrite"));
+
+  base::CommandLine optimize = app_.BuildStageCommandLine(
+      GetStage("optimize"), image, output, pdb, profile);
+  EXPECT_EQ(tool_dir_.Append(L"optimize.exe"), optimize.GetProgram());
+  EXPECT_FALSE(optimize.HasSwitch("mode"));
+  EXPECT_TRUE(optimize.HasSwitch("peephole"));
+}
+
+TEST_F(ToolchainBenchmarkAppTest, ReadPhaseProfile) {
+  static const char kProfile[] =
+      "[{\"name\": \"decompose\", \"wall_time\": 2.0, \"cpu_time\": 1.0,"
+      "  \"peak_working_set_kb\": 10},"
+      " {\"name\": \"write pdb\", \"wall_time\": 0.5, \"cpu_time\": 0.5,"
+      "  \"peak_working_set_kb\": 10,"
+      "  \"phases\": [{\"name\": \"finalize\", \"wall_time\": 0.25,"
+      "                \"cpu_time\": 0.25, \"peak_working_set_kb\": 10}]}]";
+  base::FilePath path = temp_dir_.path().Append(L"profile.json");
+  ASSERT_EQ(static_cast<int>(sizeof(kProfile) - 1),
+            base::WriteFile(path, kProfile, sizeof(kProfile) - 1));
+
+  std::map<std::string, double> phase_times_ms;
+  phase_times_ms["decompose"] = 1000.0;
+  ASSERT_TRUE(ToolchainBenchmarkApp::ReadPhaseProfile(path, &phase_times_ms));
+
+  // The shortest time of each phase is kept.
+  ASSERT_EQ(3u, phase_times_ms.size());
+  EXPECT_EQ(1000.0, phase_times_ms["decompose"]);
+  EXPECT_EQ(500.0, phase_times_ms["write_pdb"]);
+  EXPECT_EQ(250.0, phase_times_ms["write_pdb.finalize"]);
+
+  ASSERT_EQ(2, base::WriteFile(path, "{}", 2));
+  EXPECT_FALSE(ToolchainBenchmarkApp::ReadPhaseProfile(path, &phase_times_ms));
+}
+
+TEST_F(ToolchainBenchmarkAppTest, ToMetricName) {
+  EXPECT_EQ("test_dll", ToolchainBenchmarkApp::ToMetricName("test_dll"));
+  EXPECT_EQ("chrome_child_1",
+            ToolchainBenchmarkApp::ToMetricName("chrome-child.1"));
+}
+
+}  // namespace experimental
@@ -19,6 +19,7 @@
 
 #include "syzygy/experimental/code_tally/code_tally.h"
 
+#include <algorithm>
 #include <cstdio>
 
 #include "base/bind.h"
@@ -138,16 +139,17 @@ bool CodeTally::TallyLines(const base::FilePath& pdb_file) {
     return false;
   }
 
+  // Walk the PDB once, gathering functions and lines and updating the use
+  // counts. The lines can only be tallied once all use counts are known.
   pe::CompilandVisitor visitor(session_.get());
-  if (!visitor.VisitAllCompilands(base::Bind(&CodeTally::OnCompilandPassOne,
-                                        base::Unretained(this)))) {
-    return false;
-  }
-  if (!visitor.VisitAllCompilands(base::Bind(&CodeTally::OnCompilandPassTwo,
-                                              base::Unretained(this)))) {
+  if (!visitor.VisitAllCompilands(base::Bind(&CodeTally::OnCompiland,
+                                             base::Unretained(this)))) {
     return false;
   }
 
+  SumContributions();
+  TallyPendingLines();
+
   return true;
 }
 
@@ -209,18 +211,10 @@ bool CodeTally::GenerateJsonOutput(core::JSONFileWriter* writer) {
       if (!writer->OpenDict())
         return false;
 
-    // Tally the function's size.
-    const FunctionRange& fun_range = fun_it->first;
-    double fun_size = 0.0;
-    for (size_t i = 0; i < fun_range.size(); ++i) {
-      size_t offs = fun_range.start() + i;
-      // If there's no recorded line use for the location,
-      // this function is the sole contributor of the byte.
-      if (offs >= use_counts_.size() || use_counts_[offs] == 0)
-        fun_size += 1.0;
-      else
-        fun_size += 1.0 / use_counts_[offs];
-    }
+      // Tally the function's size.
+      const FunctionRange& fun_range = fun_it->first;
+      double fun_size =
+          CalculateByteContribution(fun_range.start(), fun_range.size());
 
       // Output the function's size.
       if (!writer->OutputKey("size") ||
@@ -321,6 +315,35 @@ CodeTally::ObjectFileInfo* CodeTally::FindOrCreateObjectFileInfo(
   return &it->second;
 }
 
+CodeTally::SourceFileInfo* CodeTally::FindOrCreateSourceFileInfo(
+    IDiaSourceFile* source_file) {
+  DCHECK(source_file != NULL);
+
+  DWORD id = 0;
+  HRESULT hr = source_file->get_uniqueId(&id);
+  if (hr != S_OK) {
+    LOG(ERROR) << "Failed to get source file ID: " << common::LogHr(hr);
+    return NULL;
+  }
+
+  SourceFileIdMap::const_iterator it = source_file_ids_.find(id);
+  if (it != source_file_ids_.end())
+    return it->second;
+
+  base::win::ScopedBstr source_name;
+  hr = source_file->get_fileName(source_name.Receive());
+  if (hr != S_OK) {
+    LOG(ERROR) << "Failed to get source file name for line: "
+               << common::LogHr(hr);
+    return NULL;
+  }
+
+  SourceFileInfo* source_file_info =
+      FindOrCreateSourceFileInfo(common::ToString(source_name));
+  source_file_ids_.insert(std::make_pair(id, source_file_info));
+  return source_file_info;
+}
+
 void CodeTally::UseRange(size_t start, size_t len) {
   if (use_counts_.size() < start + len)
     use_counts_.resize(start + len, 0);
@@ -329,31 +352,30 @@ void CodeTally::UseRange(size_t start, size_t len) {
     ++use_counts_[start + i];
 }
 
-double CodeTally::CalculateByteContribution(size_t start, size_t len) {
-  DCHECK_LE(start + len, use_counts_.size());
-  double sum = 0.0;
-  while (len != 0) {
-    sum += 1.0 / use_counts_[start];
-    ++start;
-    --len;
+void CodeTally::SumContributions() {
+  contribution_sums_.resize(use_counts_.size() + 1);
+  contribution_sums_[0] = 0.0;
+  for (size_t i = 0; i < use_counts_.size(); ++i) {
+    // If there's no recorded line use for the location, its function is the
+    // sole contributor of the byte.
+    double contribution = use_counts_[i] == 0 ? 1.0 : 1.0 / use_counts_[i];
+    contribution_sums_[i + 1] = contribution_sums_[i] + contribution;
   }
-  return sum;
 }
 
-bool CodeTally::OnCompilandPassOne(IDiaSymbol* compiland) {
-  DCHECK(pe::IsSymTag(compiland, SymTagCompiland));
+double CodeTally::CalculateByteContribution(size_t start, size_t len) const {
+  DCHECK_EQ(use_counts_.size() + 1, contribution_sums_.size());
 
-  base::win::ScopedBstr compiland_name;
-
-  // On the first pass, we simply crawl the source lines in this compiland
-  // and update the share counts for each referenced byte.
-  pe::LineVisitor visitor(session_.get(), compiland);
-  return visitor.VisitLines(
-      base::Bind(&CodeTally::OnLinePassOne, base::Unretained(this)));
+  // Bytes past the last one used by a line are contributed in full.
+  size_t end = start + len;
+  size_t used_end = std::min(end, use_counts_.size());
+  size_t used_start = std::min(start, used_end);
+  return contribution_sums_[used_end] - contribution_sums_[used_start] +
+      (end - used_end) + (used_start - start);
 }
 
-bool CodeTally::OnCompilandPassTwo(IDiaSymbol* compiland) {
-  DCHECK(compiland != NULL);
+bool CodeTally::OnCompiland(IDiaSymbol* compiland) {
+  DCHECK(pe::IsSymTag(compiland, SymTagCompiland));
 
   base::win::ScopedBstr compiland_name;
   ObjectFileInfo* object_file =
@@ -367,34 +389,55 @@ bool CodeTally::OnCompilandPassTwo(IDiaSymbol* compiland) {
     return false;
   }
 
-  // On the second pass we know the share count for each byte in the executable,
-  // so we can calculate accurate code contributions by line.
+  // Crawl the source lines in this compiland, updating the share counts for
+  // each referenced byte.
   pe::LineVisitor line_visitor(session_.get(), compiland);
-
   return line_visitor.VisitLines(
-      base::Bind(&CodeTally::OnLinePassTwo,
+      base::Bind(&CodeTally::OnLine,
                  base::Unretained(this),
                  object_file));
 }
 
-bool CodeTally::OnLinePassOne(IDiaLineNumber* line_number) {
+bool CodeTally::OnLine(ObjectFileInfo* object_file,
+                       IDiaLineNumber* line_number) {
+  DCHECK(object_file != NULL);
   DCHECK(line_number != NULL);
 
-  DWORD rva = 0;
-  HRESULT hr = line_number->get_relativeVirtualAddress(&rva);
+  PendingLine pending = {};
+  pending.object_file = object_file;
+
+  HRESULT hr = line_number->get_relativeVirtualAddress(&pending.rva);
   if (hr != S_OK) {
-    LOG(ERROR) << "Failed to get line number RVA: " << common::LogHr(hr);
+    LOG(ERROR) << "Failed to get RVA for line: " << common::LogHr(hr);
     return false;
   }
-  DWORD length = 0;
-  hr = line_number->get_length(&length);
+
+  hr = line_number->get_length(&pending.length);
+  if (hr != S_OK) {
+    LOG(ERROR) << "Failed to get length for line: " << common::LogHr(hr);
+    return false;
+  }
+
+  base::win::ScopedComPtr<IDiaSourceFile> source_file;
+  hr = line_number->get_sourceFile(source_file.Receive());
+  if (hr != S_OK) {
+    LOG(ERROR) << "Failed to get source file for line: " << common::LogHr(hr);
+    return false;
+  }
+
+  pending.source_file = FindOrCreateSourceFileInfo(source_file.get());
+  if (pending.source_file == NULL)
+    return false;
+
+  hr = line_number->get_lineNumber(&pending.line);
   if (hr != S_OK) {
-    LOG(ERROR) << "Failed to get line number length: " << common::LogHr(hr);
+    LOG(ERROR) << "Failed to get line number: " << common::LogHr(hr);
     return false;
   }
 
   // Account for the code usage.
-  UseRange(rva, length);
+  UseRange(pending.rva, pending.length);
+  pending_lines_.push_back(pending);
 
   return true;
 }
@@ -458,69 +501,33 @@ bool CodeTally::OnFunction(ObjectFileInfo* object_file, IDiaSymbol* function) {
   return true;
 }
 
-bool CodeTally::OnLinePassTwo(ObjectFileInfo* object_file,
-                              IDiaLineNumber* line_number) {
-  DCHECK(object_file != NULL);
-  DCHECK(line_number != NULL);
-
-  DWORD rva = 0;
-  HRESULT hr = line_number->get_relativeVirtualAddress(&rva);
-  if (hr != S_OK) {
-    LOG(ERROR) << "Failed to get RVA for line: " << common::LogHr(hr);
-    return false;
-  }
-
-  DWORD length = 0;
-  hr = line_number->get_length(&length);
-  if (hr != S_OK) {
-    LOG(ERROR) << "Failed to get length for line: " << common::LogHr(hr);
-    return false;
-  }
+void CodeTally::TallyPendingLines() {
+  for (size_t i = 0; i < pending_lines_.size(); ++i) {
+    const PendingLine& pending = pending_lines_[i];
+    ObjectFileInfo* object_file = pending.object_file;
 
-  base::win::ScopedComPtr<IDiaSourceFile> source_file;
-  hr = line_number->get_sourceFile(source_file.Receive());
-  if (hr != S_OK) {
-    LOG(ERROR) << "Failed to get source file for line: " << common::LogHr(hr);
-    return false;
-  }
+    FunctionRange line_range(pending.rva, pending.length ? pending.length : 1);
+    FunctionInfoAddressSpace::iterator it =
+        object_file->functions.FindContaining(line_range);
+    if (it == object_file->functions.end()) {
+      LOG(ERROR) << "Line info outside function in object file '"
+                 << object_file->file_name << "' source file '"
+                 << pending.source_file->file_name << "' at line: "
+                 << pending.line;
+      continue;
+    }
 
-  base::win::ScopedBstr source_name;
-  hr = source_file->get_fileName(source_name.Receive());
-  if (hr != S_OK) {
-    LOG(ERROR) << "Failed to get source file name for line: "
-               << common::LogHr(hr);
-    return false;
-  }
+    FunctionInfo::LineData line_data = {};
+    line_data.source_file = pending.source_file;
+    line_data.offset = pending.rva - it->first.start();
+    line_data.line = pending.line;
+    line_data.code_bytes =
+        CalculateByteContribution(pending.rva, pending.length);
 
-  DWORD line = 0;
-  hr = line_number->get_lineNumber(&line);
-  if (hr != S_OK) {
-    LOG(ERROR) << "Failed to get line number: " << common::LogHr(hr);
-    return false;
+    FunctionInfo& function_info = it->second;
+    function_info.line_info.push_back(line_data);
   }
 
-  FunctionRange line_range(rva, length ? length : 1);
-  FunctionInfoAddressSpace::iterator it =
-      object_file->functions.FindContaining(line_range);
-  if (it == object_file->functions.end()) {
-    LOG(ERROR) << "Line info outside function in object file '"
-               << object_file->file_name << "' source file '"
-               << common::ToString(source_name) << "' at line: " << line;
-    return true;
-  }
-
-  FunctionInfo::LineData line_data = {};
-
-  line_data.source_file =
-      FindOrCreateSourceFileInfo(common::ToString(source_name));
-  DCHECK(line_data.source_file != NULL);
-
-  line_data.offset = rva - it->first.start();
-  line_data.line = line;
-  line_data.code_bytes = CalculateByteContribution(rva, length);
-
-  FunctionInfo& function_info = it->second;
-  function_info.line_info.push_back(line_data);
-
-  return true;
+  // The lines are no longer needed.
+  std::vector<PendingLine>().swap(pending_lines_);
 }
@@ -108,11 +108,11 @@ class JSONFileWriter;
 // template function may expand to identical code for multiple types, but the
 // linker may then fold all the identical template expansions to a single,
 // canonical function.
-// We therefore have to iterate through the source lines twice:
-// - On the first pass we update the use counts for each byte referenced from
-//   source line contribution.
-// - On the second pass we know how often each code byte is shared, and so
-//   we can accrue the correct tally.
+// We therefore gather the source lines in a single pass over the PDB, updating
+// the use counts for each byte referenced from a source line contribution.
+// Once all lines are known we know how often each code byte is shared, and a
+// running sum of the per-byte shares lets us accrue the correct tally of each
+// line and function in constant time.
 class CodeTally {
  public:
   // Creates a code tally instance for the given image file.
@@ -130,9 +130,11 @@ class CodeTally {
   struct FunctionInfo;
   struct ObjectFileInfo;
   struct SourceFileInfo;
+  struct PendingLine;
 
   typedef std::map<std::wstring, SourceFileInfo> SourceFileInfoMap;
   typedef std::map<std::wstring, ObjectFileInfo> ObjectFileInfoMap;
+  typedef std::map<DWORD, SourceFileInfo*> SourceFileIdMap;
 
   typedef core::AddressSpace<size_t, size_t, FunctionInfo>
       FunctionInfoAddressSpace;
@@ -141,27 +143,34 @@ class CodeTally {
   SourceFileInfo* FindOrCreateSourceFileInfo(const wchar_t* source_file);
   ObjectFileInfo* FindOrCreateObjectFileInfo(const wchar_t* object_file);
 
+  // Finds the source file of a line, looking it up by its DIA unique ID so
+  // that its name need only be retrieved once.
+  SourceFileInfo* FindOrCreateSourceFileInfo(IDiaSourceFile* source_file);
+
   // Increases the use count for bytes [start, start + len) by one.
   void UseRange(size_t start, size_t len);
 
+  // Computes contribution_sums_ from the final use counts.
+  void SumContributions();
+
   // Sums up the total code contribution by the bytes in [start, start + len).
-  double CalculateByteContribution(size_t start, size_t len);
+  // A byte no source line refers to is contributed in full. This requires
+  // SumContributions to have been called.
+  double CalculateByteContribution(size_t start, size_t len) const;
 
-  // Callbacks for compiland enumeration.
-  bool OnCompilandPassOne(IDiaSymbol* compiland);
-  bool OnCompilandPassTwo(IDiaSymbol* compiland);
+  // Callback for compiland enumeration.
+  bool OnCompiland(IDiaSymbol* compiland);
 
-  // Callback for line enumeration.
-  // First pass only updates all use counts.
-  bool OnLinePassOne(IDiaLineNumber* line_number);
+  // Callback for line enumeration. Updates the use counts, and records the
+  // line to be tallied once the use counts are final.
+  bool OnLine(ObjectFileInfo* object_file, IDiaLineNumber* line_number);
 
   // Callback for Function enumeration.
   bool OnFunction(ObjectFileInfo* object_file, IDiaSymbol* function);
 
-  // The second pass can accurately tally code contribution as
-  // the first pass has calculated the sharing (use) count of
-  // each byte in the binary.
-  bool OnLinePassTwo(ObjectFileInfo* object_file, IDiaLineNumber* line_number);
+  // Accrues the code contribution of each recorded line to the function
+  // containing it.
+  void TallyPendingLines();
 
   // The image file we work on.
   base::FilePath image_file_;
@@ -183,10 +192,20 @@ class CodeTally {
   // Maps from source file name to SourceFileInfo.
   SourceFileInfoMap source_files_;
 
+  // Maps from DIA source file unique ID to SourceFileInfo.
+  SourceFileIdMap source_file_ids_;
+
   // Keeps track of how many times each byte in Chrome.dll was referenced from
   // any source line.
   std::vector<size_t> use_counts_;
 
+  // The running sum of the per-byte contributions: entry i is the total
+  // contribution of bytes [0, i). This has one more entry than use_counts_.
+  std::vector<double> contribution_sums_;
+
+  // The lines gathered from the PDB, waiting for the use counts to be final.
+  std::vector<PendingLine> pending_lines_;
+
   DISALLOW_COPY_AND_ASSIGN(CodeTally);
 };
 
@@ -242,4 +261,14 @@ struct CodeTally::SourceFileInfo {
   std::vector<CodeTally::LineInfo> line_code;
 };
 
+// A line gathered from the PDB, to be tallied once the use counts are final.
+struct CodeTally::PendingLine {
+  // The object file the line belongs to.
+  CodeTally::ObjectFileInfo* object_file;
+  CodeTally::SourceFileInfo* source_file;
+  DWORD rva;
+  DWORD length;
+  DWORD line;
+};
+
 #endif  // SYZYGY_EXPERIMENTAL_CODE_TALLY_CODE_TALLY_H_
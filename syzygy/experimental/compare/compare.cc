@@ -74,7 +74,9 @@
 
 #include "base/logging.h"
 #include "base/md5.h"
+#include "base/sys_info.h"
 #include "syzygy/block_graph/block_hash.h"
+#include "syzygy/block_graph/block_hash_index.h"
 #include "syzygy/common/comparable.h"
 #include "syzygy/experimental/compare/block_compare.h"
 
@@ -501,14 +503,55 @@ FeatureIndex::FeatureIndex(const BlockFeature& block_feature,
 #endif
 }
 
+// The hashes of the blocks of both block graphs, which are computed up front
+// on all processors.
+typedef std::map<const BlockGraph::Block*, block_graph::BlockHash>
+    BlockHashMap;
+
+// Indexes the blocks of @p block_graph that aren't ignored by the feature
+// indices by their hash, hashing on all processors.
+void IndexBlocks(const BlockGraph& block_graph,
+                 block_graph::BlockHashIndex* index) {
+  DCHECK(index != NULL);
+
+  block_graph::BlockHashIndex::ConstBlockVector blocks;
+  BlockGraph::BlockMap::const_iterator block_it = block_graph.blocks().begin();
+  for (; block_it != block_graph.blocks().end(); ++block_it) {
+    if ((block_it->second.attributes() & FeatureIndex::kIgnoredAttributes) == 0)
+      blocks.push_back(&block_it->second);
+  }
+
+  index->Build(blocks, base::SysInfo::NumberOfProcessors());
+}
+
+// Adds the hashes of the blocks in @p index, which indexes blocks of
+// @p block_graph, to @p hashes.
+void AddIndexedHashes(const BlockGraph& block_graph,
+                      const block_graph::BlockHashIndex& index,
+                      BlockHashMap* hashes) {
+  DCHECK(hashes != NULL);
+
+  for (const auto& entry : index.entries()) {
+    const BlockGraph::Block* block = block_graph.GetBlockById(entry.block_id);
+    DCHECK(block != NULL);
+    hashes->insert(std::make_pair(block, entry.hash));
+  }
+}
+
 class BlockHashFeature : public BlockFeature {
  public:
-  BlockHashFeature() : BlockFeature(kHashFeature) {
+  explicit BlockHashFeature(const BlockHashMap& hashes)
+      : BlockFeature(kHashFeature), hashes_(hashes) {
   }
 
   virtual bool InitMetadata(BlockMetadata* metadata) const {
     DCHECK(metadata != NULL);
-    metadata->block_hash.Hash(metadata->block);
+    BlockHashMap::const_iterator it = hashes_.find(metadata->block);
+    if (it != hashes_.end()) {
+      metadata->block_hash = it->second;
+    } else {
+      metadata->block_hash.Hash(metadata->block);
+    }
     return true;
   }
 
@@ -520,6 +563,9 @@ class BlockHashFeature : public BlockFeature {
 
     return BlockCompare(metadata0.block, metadata1.block);
   }
+
+ private:
+  const BlockHashMap& hashes_;
 };
 
 class BlockNameFeature : public BlockFeature {
@@ -644,8 +690,16 @@ bool BlockGraphMapper::BuildMapping(const BlockGraph& bg0,
   mapping_ = mapping;
   mapping_->clear();
 
-  // Build the feature indices.
-  BlockHashFeature hash_feature;
+  // Index the blocks of both block graphs by hash, and build the feature
+  // indices.
+  block_graph::BlockHashIndex index0;
+  block_graph::BlockHashIndex index1;
+  IndexBlocks(bg0, &index0);
+  IndexBlocks(bg1, &index1);
+  BlockHashMap hashes;
+  AddIndexedHashes(bg0, index0, &hashes);
+  AddIndexedHashes(bg1, index1, &hashes);
+  BlockHashFeature hash_feature(hashes);
   feature_indices_[kHashFeature].reset(
       new FeatureIndex(hash_feature, bg0, bg1));
 #ifdef USE_BLOCK_NAME_FEATURE
@@ -654,20 +708,35 @@ bool BlockGraphMapper::BuildMapping(const BlockGraph& bg0,
       new FeatureIndex(name_feature, bg0, bg1));
 #endif
 
-  // Iterate through each index.
-  for (size_t i = 0; i < kFeatureCount; ++i) {
-    // Iterate through the unique feature values. For every feature value we
-    // find that contains only a single block per block-graph, we can infer that
-    // these blocks are identical. Use these as a root for matching up blocks.
-    for (size_t j = 0; j < feature_indices_[i]->size(); ++j) {
-      if (feature_indices_[i]->ExistUniqueBlocks(j)) {
-        if (!ScheduleUniqueBucketMapping(i, j)) {
+  // Iterate through the unique feature values. For every feature value we
+  // find that contains only a single block per block-graph, we can infer that
+  // these blocks are identical. Use these as a root for matching up blocks.
+  // The name feature has priority.
+  if (feature_indices_[kNameFeature].get() != NULL) {
+    for (size_t j = 0; j < feature_indices_[kNameFeature]->size(); ++j) {
+      if (feature_indices_[kNameFeature]->ExistUniqueBlocks(j)) {
+        if (!ScheduleUniqueBucketMapping(kNameFeature, j))
           return false;
-        }
       }
     }
   }
 
+  // The blocks that are unique to their hash in each block graph are found in
+  // a single pass over both hash indices. Comparing the blocks rules out hash
+  // collisions.
+  block_graph::BlockHashIndex::BlockIdPairVector matches;
+  index0.MatchUnique(index1, &matches);
+  for (size_t i = 0; i < matches.size(); ++i) {
+    const BlockGraph::Block* block0 = bg0.GetBlockById(matches[i].first);
+    const BlockGraph::Block* block1 = bg1.GetBlockById(matches[i].second);
+    DCHECK(block0 != NULL);
+    DCHECK(block1 != NULL);
+    if (BlockCompare(block0, block1) != 0)
+      continue;
+    if (!ScheduleMapping(block0, block1))
+      return false;
+  }
+
   // Loop until there are no more blocks left to map.
   while (!pending_.empty()) {
     const BlockGraph::Block* block0 = pending_.begin()->first;
@@ -686,9 +755,9 @@ bool BlockGraphMapper::BuildMapping(const BlockGraph& bg0,
 
   // If provided, fill out the list of unmapped blocks.
   if (unmapped0 != NULL)
-    feature_indices_[0]->GetUnmappedBlocks(0, unmapped0);
+    feature_indices_[kHashFeature]->GetUnmappedBlocks(0, unmapped0);
   if (unmapped1 != NULL)
-    feature_indices_[0]->GetUnmappedBlocks(1, unmapped1);
+    feature_indices_[kHashFeature]->GetUnmappedBlocks(1, unmapped1);
 
   return true;
 }
@@ -696,8 +765,8 @@ bool BlockGraphMapper::BuildMapping(const BlockGraph& bg0,
 bool BlockGraphMapper::ScheduleMapping(const BlockGraph::Block* block0,
                                        const BlockGraph::Block* block1) {
   // Neither block should yet be mapped.
-  DCHECK(!feature_indices_[0]->BlockIsMapped(block0));
-  DCHECK(!feature_indices_[0]->BlockIsMapped(block1));
+  DCHECK(!feature_indices_[kHashFeature]->BlockIsMapped(block0));
+  DCHECK(!feature_indices_[kHashFeature]->BlockIsMapped(block1));
 
   // Use the pending_ and pending_reverse_ to ensure that neither of these
   // blocks are already scheduled for mapping. If they are, then we ignore
@@ -786,6 +855,10 @@ bool BlockGraphMapper::MapBlocks(const BlockGraph::Block* block0,
   // Map the blocks in each feature. If the mapping causes any other feature
   // buckets to become unique, pursue those as well.
   for (size_t i = 0; i < kFeatureCount; ++i) {
+    // The name feature is optional.
+    if (feature_indices_[i].get() == NULL)
+      continue;
+
     size_t unique_bucket0 = FeatureIndex::kInvalidFeatureBucket;
     size_t unique_bucket1 = FeatureIndex::kInvalidFeatureBucket;
     feature_indices_[i]->MarkAsMapped(block0, block1,
@@ -892,8 +965,8 @@ bool BlockGraphMapper::ScheduleReferrerMappings(const BlockGraph::Block* block0,
 bool BlockGraphMapper::ScheduleIfUnmapped(const BlockGraph::Block* block0,
                                           const BlockGraph::Block* block1) {
   // Schedule the blocks for mapping if they arent
-  if (feature_indices_[0]->BlockIsMapped(block0) ||
-      feature_indices_[0]->BlockIsMapped(block1))
+  if (feature_indices_[kHashFeature]->BlockIsMapped(block0) ||
+      feature_indices_[kHashFeature]->BlockIsMapped(block1))
     return true;
 
   return ScheduleMapping(block0, block1);
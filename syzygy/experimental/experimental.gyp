@@ -21,6 +21,7 @@
       'target_name': 'experimental',
       'type': 'none',
       'dependencies': [
+        '<(src)/syzygy/experimental/benchmark/benchmark.gyp:*',
         '<(src)/syzygy/experimental/code_tally/code_tally.gyp:*',
         '<(src)/syzygy/experimental/compare/compare.gyp:*',
         '<(src)/syzygy/experimental/heap_enumerate/heap_enumerate.gyp:*',
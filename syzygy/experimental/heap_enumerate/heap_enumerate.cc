@@ -30,9 +30,11 @@
 #include "base/strings/string16.h"
 #include "base/strings/string_piece.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/sys_info.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/refinery/core/address.h"
 #include "syzygy/refinery/core/bit_source.h"
+#include "syzygy/refinery/core/page_cache_bit_source.h"
 #include "syzygy/refinery/testing/self_bit_source.h"
 #include "syzygy/refinery/types/dia_crawler.h"
 #include "syzygy/refinery/types/type_repository.h"
@@ -48,7 +50,12 @@ using refinery::AddressRange;
 using refinery::ArrayTypePtr;
 using refinery::BitSource;
 using refinery::DiaCrawler;
+using refinery::HeapAllocationLayerPtr;
+using refinery::HeapAllocationRecordPtr;
+using refinery::HeapMetadataLayerPtr;
+using refinery::HeapMetadataRecordPtr;
 using refinery::MemberFieldPtr;
+using refinery::ProcessState;
 using refinery::TypeRepository;
 using refinery::TypePtr;
 using refinery::TypedData;
@@ -79,6 +86,61 @@ bool GetNamedValueUnsigned(const refinery::TypedData& data,
   return true;
 }
 
+// Records a heap entry, and the allocation it holds, in the heap layers of
+// @p process_state, the same way the heap analyzer does.
+// @param header_range the range of the entry's header.
+// @param entry_byte_size the size of the entry, header inclusive.
+// @param busy true iff the entry holds a live allocation.
+// @param unused_bytes the number of unused bytes in the entry, header
+//     inclusive. Ignored unless @p busy.
+// @param corrupt true iff the entry's header is known to be corrupt.
+// @param process_state the process state to record to.
+void RecordEntry(const AddressRange& header_range,
+                 uint64_t entry_byte_size,
+                 bool busy,
+                 uint8_t unused_bytes,
+                 bool corrupt,
+                 ProcessState* process_state) {
+  DCHECK(process_state);
+
+  HeapMetadataLayerPtr meta_layer;
+  process_state->FindOrCreateLayer(&meta_layer);
+  HeapAllocationLayerPtr alloc_layer;
+  process_state->FindOrCreateLayer(&alloc_layer);
+
+  bool is_free = true;
+  uint64_t allocation_size = 0;
+  if (entry_byte_size < header_range.size()) {
+    corrupt = true;
+  } else {
+    allocation_size = entry_byte_size - header_range.size();
+    if (busy) {
+      if (unused_bytes < header_range.size() ||
+          unused_bytes - header_range.size() >= allocation_size) {
+        // This is un-possible, must be corruption.
+        corrupt = true;
+      } else {
+        allocation_size -= unused_bytes - header_range.size();
+        is_free = false;
+      }
+    }
+  }
+
+  HeapMetadataRecordPtr meta_record;
+  meta_layer->CreateRecord(header_range, &meta_record);
+  meta_record->mutable_data()->set_corrupt(corrupt);
+
+  if (allocation_size == 0)
+    return;
+
+  HeapAllocationRecordPtr alloc_record;
+  alloc_layer->CreateRecord(
+      AddressRange(header_range.end(),
+                   static_cast<refinery::Size>(allocation_size)),
+      &alloc_record);
+  alloc_record->mutable_data()->set_is_free(is_free);
+}
+
 void Spaces(FILE* output, size_t indent) {
   for (size_t i = 0; i < indent; ++i)
     std::fputc(' ', output);
@@ -131,6 +193,14 @@ class HeapEnumerate::HeapEnumerator {
   // Get an enumerator for a segment's UCR list.
   ListEntryEnumerator GetUCREnumerator(const TypedData& segment);
 
+  // Gets the committed ranges of a segment, which are the segment's range
+  // less its uncommitted ranges.
+  // @param segment the segment.
+  // @param ranges receives the committed ranges of @p segment.
+  // @returns true on success, false otherwise.
+  bool GetCommittedRanges(const TypedData& segment,
+                          std::vector<AddressRange>* ranges);
+
   // Retrieves the front end heap - if enabled.
   bool GetFrontEndHeap(TypedData* front_end_heap);
 
@@ -140,13 +210,17 @@ class HeapEnumerate::HeapEnumerator {
   UserDefinedTypePtr heap_userdata_header_type() const {
     return heap_userdata_header_type_;
   }
-  BitSource* bit_source() const {
-    return const_cast<testing::SelfBitSource*>(&bit_source_);
+  refinery::PageCacheBitSource* bit_source() const {
+    return const_cast<refinery::PageCacheBitSource*>(&bit_source_);
   }
 
  private:
   // A reflective bit source.
-  testing::SelfBitSource bit_source_;
+  testing::SelfBitSource self_bit_source_;
+
+  // The heap metadata is read in many small reads, so they're served from a
+  // cache of the pages of self_bit_source_.
+  refinery::PageCacheBitSource bit_source_;
 
   // The heap we're enumerating.
   TypedData heap_;
@@ -188,7 +262,8 @@ class HeapEnumerate::HeapEnumerator {
   UserDefinedTypePtr heap_userdata_header_type_;
 };
 
-HeapEnumerate::HeapEnumerator::HeapEnumerator() {
+HeapEnumerate::HeapEnumerator::HeapEnumerator()
+    : bit_source_(&self_bit_source_) {
 }
 
 bool HeapEnumerate::HeapEnumerator::Initialize(HANDLE heap,
@@ -277,6 +352,48 @@ ListEntryEnumerator HeapEnumerate::HeapEnumerator::GetUCREnumerator(
   return ucr_list_enum;
 }
 
+bool HeapEnumerate::HeapEnumerator::GetCommittedRanges(
+    const TypedData& segment,
+    std::vector<AddressRange>* ranges) {
+  DCHECK(ranges);
+
+  uint64_t last_valid_entry = 0;
+  if (!GetNamedValueUnsigned(segment, L"LastValidEntry", &last_valid_entry) ||
+      last_valid_entry <= segment.addr()) {
+    return false;
+  }
+
+  // Gather the uncommitted ranges, in order.
+  std::map<Address, uint64_t> uncommitted;
+  ListEntryEnumerator enum_ucrs = GetUCREnumerator(segment);
+  while (enum_ucrs.Next()) {
+    uint64_t address = 0;
+    uint64_t size = 0;
+    if (!GetNamedValueUnsigned(enum_ucrs.current_record(), L"Address",
+                               &address) ||
+        !GetNamedValueUnsigned(enum_ucrs.current_record(), L"Size", &size)) {
+      return false;
+    }
+    uncommitted[address] = size;
+  }
+
+  // The committed ranges are the gaps between them.
+  Address start = segment.addr();
+  for (const auto& ucr : uncommitted) {
+    if (ucr.first > start) {
+      ranges->push_back(AddressRange(
+          start, static_cast<refinery::Size>(ucr.first - start)));
+    }
+    start = std::max(start, ucr.first + ucr.second);
+  }
+  if (last_valid_entry > start) {
+    ranges->push_back(AddressRange(
+        start, static_cast<refinery::Size>(last_valid_entry - start)));
+  }
+
+  return true;
+}
+
 bool HeapEnumerate::HeapEnumerator::GetFrontEndHeap(TypedData* front_end_heap) {
   DCHECK(front_end_heap);
   uint64_t front_end_heap_type = 0;
@@ -303,7 +420,8 @@ bool HeapEnumerate::HeapEnumerator::GetFrontEndHeap(TypedData* front_end_heap) {
   return true;
 }
 
-HeapEnumerate::HeapEnumerate() : heap_(nullptr), output_(nullptr) {
+HeapEnumerate::HeapEnumerate()
+    : heap_(nullptr), output_(nullptr), process_state_(nullptr) {
 }
 
 HeapEnumerate::~HeapEnumerate() {
@@ -413,9 +531,11 @@ void HeapEnumerate::DumpTypedData(const TypedData& data, size_t indent) {
   }
 }
 
-void HeapEnumerate::EnumerateHeap(FILE* output_file) {
+void HeapEnumerate::EnumerateHeap(FILE* output_file,
+                                  ProcessState* process_state) {
   DCHECK(output_file);
   output_ = output_file;
+  process_state_ = process_state;
 
   if (!Initialize())
     return;
@@ -436,10 +556,22 @@ void HeapEnumerate::EnumerateHeap(FILE* output_file) {
     DumpTypedData(front_end_heap, 0);
 
   // Enumerate the segments of the heap, by walking the segment list.
+  std::vector<TypedData> segments;
   ListEntryEnumerator enum_segments = enumerator.GetSegmentEnumerator();
-  while (enum_segments.Next()) {
-    TypedData segment = enum_segments.current_record();
+  while (enum_segments.Next())
+    segments.push_back(enum_segments.current_record());
+
+  // Fetch the committed ranges of all segments up front, so that walking the
+  // entries is served from the cache. The segments are fetched in parallel.
+  std::vector<AddressRange> committed_ranges;
+  for (const TypedData& segment : segments) {
+    if (!enumerator.GetCommittedRanges(segment, &committed_ranges))
+      LOG(ERROR) << "Failed to get the committed ranges of a segment.";
+  }
+  enumerator.bit_source()->Prefetch(committed_ranges,
+                                    base::SysInfo::NumberOfProcessors());
 
+  for (const TypedData& segment : segments) {
     DumpTypedData(segment, 0);
 
     // This is used to walk the entries in each segment.
@@ -481,6 +613,16 @@ void HeapEnumerate::EnumSegment(const HeapEnumerator& enumerator,
     // The address range covered by the current entry.
     refinery::AddressRange range(segment_walker->curr_entry().addr(),
                                  entry.size * sizeof(entry));
+
+    // The entries hosting LFH bins are recorded as metadata only, as their
+    // contents are the bins' entries.
+    if (process_state_ != nullptr) {
+      bool is_lfh_bin = (entry.flags & HEAP_ENTRY_VIRTUAL_ALLOC) != 0;
+      RecordEntry(AddressRange(range.start(), sizeof(entry)),
+                  is_lfh_bin ? sizeof(entry) : range.size(),
+                  (entry.flags & HEAP_ENTRY_BUSY) != 0, entry.unused_bytes,
+                  checksum != entry.tag, process_state_);
+    }
     ::fprintf(output_, "Entry@0x%08llX(%d)\n", range.start(), range.size());
 
     ::fprintf(output_, " size: 0x%04X\n", entry.size);
@@ -553,6 +695,18 @@ void HeapEnumerate::EnumLFHBin(const HeapEnumerator& enumerator,
     refinery::AddressRange range(bin_walker->curr_entry().addr(),
                                  bin_walker->entry_byte_size());
 
+    if (process_state_ != nullptr) {
+      // The unused bytes are the extended block signature in an LFH entry,
+      // whose high bit is always set. The remainder is zero in a free entry.
+      const uint8_t kLFHBlockFlag = 0x80;
+      bool has_flag = (entry.unused_bytes & kLFHBlockFlag) != 0;
+      uint8_t unused_bytes =
+          static_cast<uint8_t>(entry.unused_bytes & ~kLFHBlockFlag);
+      RecordEntry(AddressRange(range.start(), sizeof(entry)), range.size(),
+                  has_flag && unused_bytes != 0, unused_bytes, !has_flag,
+                  process_state_);
+    }
+
     ::fprintf(output_, "LFHEntry@0x%08llX(%d)\n", range.start(), range.size());
 
     // TODO(siggi): Validate that each entry points to the same
@@ -22,6 +22,7 @@
 #include <map>
 
 #include "syzygy/refinery/core/address.h"
+#include "syzygy/refinery/process_state/process_state.h"
 #include "syzygy/refinery/types/type.h"
 #include "syzygy/refinery/types/typed_data.h"
 
@@ -35,7 +36,13 @@ class HeapEnumerate {
   ~HeapEnumerate();
 
   bool Initialize();
-  void EnumerateHeap(FILE* output_file);
+
+  // Enumerates the heap, dumping it to @p output_file.
+  // @param output_file the file to dump the heap to.
+  // @param process_state if not null, the heap entries and allocations are
+  //     recorded to the heap metadata and heap allocation layers of this
+  //     process state, as the heap analyzer would.
+  void EnumerateHeap(FILE* output_file, refinery::ProcessState* process_state);
 
  private:
   class HeapEnumerator;
@@ -53,6 +60,7 @@ class HeapEnumerate {
 
   HANDLE heap_;
   FILE* output_;
+  refinery::ProcessState* process_state_;
   std::map<refinery::Address, size_t> allocs_;
 };
 
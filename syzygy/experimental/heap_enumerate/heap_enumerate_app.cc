@@ -21,6 +21,7 @@
 #include "syzygy/core/json_file_writer.h"
 #include "syzygy/experimental/heap_enumerate/heap_enumerate.h"
 #include "syzygy/pe/pe_file.h"
+#include "syzygy/refinery/process_state/process_state.h"
 
 namespace {
 
@@ -82,9 +83,18 @@ int HeapEnumerateApp::Run() {
   }
 
   HeapEnumerate enumerate;
+  refinery::ProcessState process_state;
 
   // And write the output file.
-  enumerate.EnumerateHeap(output_file);
+  enumerate.EnumerateHeap(output_file, &process_state);
+
+  // Summarize what was recorded for the analyzers.
+  refinery::HeapMetadataLayerPtr meta_layer;
+  refinery::HeapAllocationLayerPtr alloc_layer;
+  process_state.FindOrCreateLayer(&meta_layer);
+  process_state.FindOrCreateLayer(&alloc_layer);
+  ::fprintf(output_file, "Recorded %d heap entries and %d allocations.\n",
+            meta_layer->size(), alloc_layer->size());
 
   return 0;
 }
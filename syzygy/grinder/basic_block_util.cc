@@ -23,8 +23,10 @@
 #include "syzygy/common/binary_stream.h"
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/grinder/indexed_frequency_data_serializer.h"
+#include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_stream_reader.h"
+#include "syzygy/pdb/pdb_string_table.h"
 #include "syzygy/pdb/pdb_util.h"
 #include "syzygy/pe/find.h"
 
@@ -136,26 +138,28 @@ bool LoadBasicBlockRanges(const base::FilePath& pdb_path,
   }
 
   // Get the name-stream map from the PDB.
-  pdb::PdbInfoHeader70 pdb_header = {};
-  pdb::NameStreamMap name_stream_map;
-  if (!pdb::ReadHeaderInfoStream(pdb_file, &pdb_header, &name_stream_map)) {
+  scoped_refptr<pdb::PdbStream> header_stream =
+      pdb_file.GetStream(pdb::kPdbHeaderInfoStream);
+  pdb::PdbNameStreamTable name_stream_table;
+  if (header_stream.get() == NULL ||
+      !name_stream_table.Init(header_stream.get())) {
     LOG(ERROR) << "Failed to read PDB header info stream: " << pdb_path.value();
     return false;
   }
 
   // Get the basic block addresses from the PDB file.
-  pdb::NameStreamMap::const_iterator name_it = name_stream_map.find(
-      common::kBasicBlockRangesStreamName);
-  if (name_it == name_stream_map.end()) {
+  uint32_t stream_id = 0;
+  if (!name_stream_table.FindStream(common::kBasicBlockRangesStreamName,
+                                    &stream_id)) {
     LOG(ERROR) << "PDB does not contain basic block ranges stream: "
                << pdb_path.value();
     return false;
   }
   scoped_refptr<pdb::PdbStream> bb_ranges_stream;
-  bb_ranges_stream = pdb_file.GetStream(name_it->second);
+  bb_ranges_stream = pdb_file.GetStream(stream_id);
   if (bb_ranges_stream.get() == NULL) {
     LOG(ERROR) << "PDB basic block ranges stream has invalid index: "
-               << name_it->second;
+               << stream_id;
     return false;
   }
 
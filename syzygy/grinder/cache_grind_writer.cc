@@ -14,18 +14,61 @@
 
 #include "syzygy/grinder/cache_grind_writer.h"
 
-#include "base/files/file_util.h"
-#include "base/strings/string_util.h"
+#include <algorithm>
+
+#include "base/sys_info.h"
+#include "syzygy/grinder/coverage_record_writer.h"
 
 namespace grinder {
 
+namespace {
+
+// Formats the CacheGrind record of a source file.
+void FormatCacheGrindRecord(const std::string& source_file,
+                            const CoverageData::SourceFileCoverageData& data,
+                            std::string* record) {
+  DCHECK(record != NULL);
+
+  // Output the path, being sure to use forward slashes instead of
+  // back slashes.
+  record->append("fl=");
+  size_t path_begin = record->size();
+  record->append(source_file);
+  std::replace(record->begin() + path_begin, record->end(), '\\', '/');
+  record->append("\n");
+
+  // We need to output a dummy function name for cache-grind aggregation to
+  // work appropriately.
+  record->append("fn=all\n");
+
+  // Iterate over the instrumented lines. We output deltas to save space so
+  // keep track of the previous line. Lines are 1 indexed so we can use zero
+  // as a special value.
+  size_t prev_line = 0;
+  for (const auto& line : data.line_execution_count_map) {
+    if (prev_line == 0) {
+      // Output the raw line number.
+      AppendDecimal(line.first, record);
+    } else {
+      // Output the line number as a delta from the previous line number.
+      DCHECK_LT(prev_line, line.first);
+      record->push_back('+');
+      AppendDecimal(line.first - prev_line, record);
+    }
+    record->append(" 1 ");
+    AppendDecimal(line.second, record);
+    record->push_back('\n');
+    prev_line = line.first;
+  }
+}
+
+}  // namespace
+
 bool WriteCacheGrindCoverageFile(const CoverageData& coverage,
                                  const base::FilePath& path) {
-  base::ScopedFILE file(base::OpenFile(path, "wb"));
-  if (file.get() == NULL) {
-    LOG(ERROR) << "Failed to open file for writing: " << path.value();
+  base::ScopedFILE file;
+  if (!OpenCoverageFileForWriting(path, &file))
     return false;
-  }
 
   if (!WriteCacheGrindCoverageFile(coverage, file.get())) {
     LOG(ERROR) << "Failed to write CacheGrind file: " << path.value();
@@ -44,51 +87,8 @@ bool WriteCacheGrindCoverageFile(const CoverageData& coverage, FILE* file) {
   if (::fprintf(file, "events: Instrumented Executed\n") < 0)
     return false;
 
-  // Iterate over the source files.
-  CoverageData::SourceFileCoverageDataMap::const_iterator source_it =
-      coverage.source_file_coverage_data_map().begin();
-  CoverageData::SourceFileCoverageDataMap::const_iterator source_it_end =
-      coverage.source_file_coverage_data_map().end();
-  for (; source_it != source_it_end; ++source_it) {
-    // Output the path, being sure to use forward slashes instead of
-    // back slashes.
-    std::string path = source_it->first;
-    if (!base::ReplaceChars(path, "\\", "/", &path))
-      return false;
-    if (::fprintf(file, "fl=%s\n", path.c_str()) < 0)
-      return false;
-
-    // We need to output a dummy function name for cache-grind aggregation to
-    // work appropriately.
-    if (::fprintf(file, "fn=all\n") < 0)
-      return false;
-
-    // Iterate over the instrumented lines. We output deltas to save space so
-    // keep track of the previous line. Lines are 1 indexed so we can use zero
-    // as a special value.
-    size_t prev_line = 0;
-    CoverageData::LineExecutionCountMap::const_iterator line_it =
-        source_it->second.line_execution_count_map.begin();
-    CoverageData::LineExecutionCountMap::const_iterator line_it_end =
-        source_it->second.line_execution_count_map.end();
-    for (; line_it != line_it_end; ++line_it) {
-      if (prev_line == 0) {
-        // Output the raw line number.
-        if (::fprintf(file, "%d 1 %d\n", line_it->first, line_it->second) < 0)
-          return false;
-      } else {
-        // Output the line number as a delta from the previous line number.
-        DCHECK_LT(prev_line, line_it->first);
-        if (::fprintf(file, "+%d 1 %d\n", line_it->first - prev_line,
-                      line_it->second) < 0) {
-          return false;
-        }
-      }
-      prev_line = line_it->first;
-    }
-  }
-
-  return true;
+  return WriteCoverageRecords(coverage, &FormatCacheGrindRecord,
+                              base::SysInfo::NumberOfProcessors(), file);
 }
 
 }  // namespace grinder
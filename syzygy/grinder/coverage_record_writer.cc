@@ -0,0 +1,169 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/grinder/coverage_record_writer.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "base/files/file_util.h"
+#include "base/threading/simple_thread.h"
+
+namespace grinder {
+
+namespace {
+
+typedef CoverageData::SourceFileCoverageDataMap::value_type SourceFileEntry;
+
+// The number of source files formatted per batch. This bounds the memory used
+// by the formatted records, while leaving plenty of work per thread.
+const size_t kSourceFilesPerBatch = 4096;
+
+// The number of source files each thread claims at a time.
+const size_t kSourceFilesPerClaim = 64;
+
+// The size of the buffer of coverage files.
+const size_t kCoverageFileBufferSize = 1024 * 1024;
+
+// Formats the records of a batch of source files. Each thread claims source
+// files a few at a time, until there are none left.
+class BatchFormatter : public base::DelegateSimpleThreadPool::Delegate {
+ public:
+  BatchFormatter(CoverageRecordFormatter formatter,
+                 const std::vector<const SourceFileEntry*>& entries,
+                 std::vector<std::string>* records)
+      : formatter_(formatter),
+        entries_(entries),
+        records_(records),
+        next_entry_(0) {
+    DCHECK(formatter != NULL);
+    DCHECK(records != NULL);
+    DCHECK_EQ(entries.size(), records->size());
+  }
+
+  // @name base::DelegateSimpleThreadPool::Delegate implementation.
+  // @{
+  void Run() override {
+    while (true) {
+      base::subtle::Atomic32 claimed = base::subtle::NoBarrier_AtomicIncrement(
+          &next_entry_, kSourceFilesPerClaim);
+      size_t begin = static_cast<size_t>(claimed) - kSourceFilesPerClaim;
+      if (begin >= entries_.size())
+        return;
+      size_t end = std::min(begin + kSourceFilesPerClaim, entries_.size());
+      for (size_t i = begin; i < end; ++i) {
+        (*records_)[i].clear();
+        formatter_(entries_[i]->first, entries_[i]->second, &(*records_)[i]);
+      }
+    }
+  }
+  // @}
+
+ private:
+  CoverageRecordFormatter formatter_;
+  const std::vector<const SourceFileEntry*>& entries_;
+  std::vector<std::string>* records_;
+  base::subtle::Atomic32 next_entry_;
+
+  DISALLOW_COPY_AND_ASSIGN(BatchFormatter);
+};
+
+}  // namespace
+
+bool WriteCoverageRecords(const CoverageData& coverage,
+                          CoverageRecordFormatter formatter,
+                          size_t num_threads,
+                          FILE* file) {
+  DCHECK(formatter != NULL);
+  DCHECK_LT(0u, num_threads);
+  DCHECK(file != NULL);
+
+  // Flatten the source files into an array. The map is sorted, and so is the
+  // array.
+  const CoverageData::SourceFileCoverageDataMap& source_files =
+      coverage.source_file_coverage_data_map();
+  std::vector<const SourceFileEntry*> entries;
+  entries.reserve(source_files.size());
+  for (const auto& entry : source_files)
+    entries.push_back(&entry);
+
+  std::vector<const SourceFileEntry*> batch;
+  std::vector<std::string> records;
+  std::string output;
+  for (size_t i = 0; i < entries.size(); i += kSourceFilesPerBatch) {
+    size_t end = std::min(i + kSourceFilesPerBatch, entries.size());
+    batch.assign(entries.begin() + i, entries.begin() + end);
+    records.resize(batch.size());
+
+    BatchFormatter batch_formatter(formatter, batch, &records);
+    size_t num_workers = std::min(
+        num_threads,
+        (batch.size() + kSourceFilesPerClaim - 1) / kSourceFilesPerClaim);
+    if (num_workers <= 1) {
+      batch_formatter.Run();
+    } else {
+      base::DelegateSimpleThreadPool pool("WriteCoverageRecords",
+                                          static_cast<int>(num_workers));
+      pool.Start();
+      pool.AddWork(&batch_formatter, static_cast<int>(num_workers));
+      pool.JoinAll();
+    }
+
+    // Write the batch in one go, in order.
+    output.clear();
+    for (const std::string& record : records)
+      output.append(record);
+    if (!output.empty() &&
+        ::fwrite(output.data(), 1, output.size(), file) != output.size()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool OpenCoverageFileForWriting(const base::FilePath& path,
+                                base::ScopedFILE* file) {
+  DCHECK(file != NULL);
+
+  file->reset(base::OpenFile(path, "wb"));
+  if (file->get() == NULL) {
+    LOG(ERROR) << "Failed to open file for writing: " << path.value();
+    return false;
+  }
+
+  // This must happen before any other operation on the file. A failure only
+  // leaves the default buffer in place.
+  if (::setvbuf(file->get(), NULL, _IOFBF, kCoverageFileBufferSize) != 0)
+    LOG(WARNING) << "Failed to set the buffer of: " << path.value();
+
+  return true;
+}
+
+void AppendDecimal(uint64_t value, std::string* str) {
+  DCHECK(str != NULL);
+
+  // Format the digits backwards in a buffer large enough for any value.
+  char buffer[20];
+  char* digits = buffer + sizeof(buffer);
+  do {
+    *--digits = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  str->append(digits, buffer + sizeof(buffer));
+}
+
+}  // namespace grinder
@@ -0,0 +1,71 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares utilities shared by the coverage file writers. The per source file
+// records of a coverage file are independent of each other, so they are
+// formatted in parallel and streamed to the file in order.
+
+#ifndef SYZYGY_GRINDER_COVERAGE_RECORD_WRITER_H_
+#define SYZYGY_GRINDER_COVERAGE_RECORD_WRITER_H_
+
+#include <stdio.h>
+
+#include <string>
+
+#include "base/files/file_path.h"
+#include "base/files/scoped_file.h"
+#include "syzygy/grinder/coverage_data.h"
+
+namespace grinder {
+
+// Formats the record of a source file.
+// @param source_file the path of the source file.
+// @param data the coverage data of the source file.
+// @param record the string to append the record to.
+typedef void (*CoverageRecordFormatter)(
+    const std::string& source_file,
+    const CoverageData::SourceFileCoverageData& data,
+    std::string* record);
+
+// Writes the records of all of the source files in @p coverage to @p file, in
+// the order of the source files. The records are formatted a batch of source
+// files at a time, in parallel, and each batch is written with a single call.
+// @param coverage the coverage data to write.
+// @param formatter the function formatting the record of a source file. This
+//     is invoked concurrently.
+// @param num_threads the number of threads to format with.
+// @param file the file to write to.
+// @returns true on success, false otherwise.
+bool WriteCoverageRecords(const CoverageData& coverage,
+                          CoverageRecordFormatter formatter,
+                          size_t num_threads,
+                          FILE* file);
+
+// Opens a coverage file for writing, with a buffer large enough that the
+// records don't go to the disk piecemeal.
+// @param path the path to the file to be created or overwritten.
+// @param file receives the opened file.
+// @returns true on success, false otherwise.
+bool OpenCoverageFileForWriting(const base::FilePath& path,
+                                base::ScopedFILE* file);
+
+// Appends the decimal representation of @p value to @p str. This is much
+// cheaper than going through a printf-style format string.
+// @param value the value to append.
+// @param str the string to append to.
+void AppendDecimal(uint64_t value, std::string* str);
+
+}  // namespace grinder
+
+#endif  // SYZYGY_GRINDER_COVERAGE_RECORD_WRITER_H_
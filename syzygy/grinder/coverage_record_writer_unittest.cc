@@ -0,0 +1,113 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/grinder/coverage_record_writer.h"
+
+#include "base/files/file_util.h"
+#include "base/strings/stringprintf.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+
+namespace grinder {
+
+namespace {
+
+class TestCoverageData : public CoverageData {
+ public:
+  // Adds @p file_count source files, with a few lines each.
+  void InitDummyData(size_t file_count) {
+    for (size_t i = 0; i < file_count; ++i) {
+      std::string source_file =
+          base::StringPrintf("file%05d.cc", static_cast<int>(i));
+      CoverageData::SourceFileCoverageDataMap::iterator source_it =
+          source_file_coverage_data_map_.insert(
+              std::make_pair(source_file,
+                             CoverageData::SourceFileCoverageData())).first;
+      for (size_t line = 1; line <= i % 7 + 1; ++line) {
+        source_it->second.line_execution_count_map.insert(
+            std::make_pair(line * 3, static_cast<uint32_t>(i * line)));
+      }
+    }
+  }
+};
+
+void FormatTestRecord(const std::string& source_file,
+                      const CoverageData::SourceFileCoverageData& data,
+                      std::string* record) {
+  record->append(source_file);
+  for (const auto& line : data.line_execution_count_map) {
+    record->push_back(' ');
+    AppendDecimal(line.first, record);
+    record->push_back(':');
+    AppendDecimal(line.second, record);
+  }
+  record->push_back('\n');
+}
+
+// Writes the records of @p coverage with @p num_threads threads, and returns
+// the contents of the resulting file.
+std::string WriteRecords(const CoverageData& coverage, size_t num_threads) {
+  testing::ScopedTempFile temp;
+  base::ScopedFILE file;
+  EXPECT_TRUE(OpenCoverageFileForWriting(temp.path(), &file));
+  EXPECT_TRUE(WriteCoverageRecords(coverage, &FormatTestRecord, num_threads,
+                                   file.get()));
+  file.reset();
+
+  std::string contents;
+  EXPECT_TRUE(base::ReadFileToString(temp.path(), &contents));
+  return contents;
+}
+
+}  // namespace
+
+TEST(CoverageRecordWriterTest, AppendDecimal) {
+  std::string str("x");
+  AppendDecimal(0, &str);
+  AppendDecimal(7, &str);
+  AppendDecimal(10, &str);
+  AppendDecimal(4294967295u, &str);
+  EXPECT_EQ("x07104294967295", str);
+
+  str.clear();
+  AppendDecimal(18446744073709551615ull, &str);
+  EXPECT_EQ("18446744073709551615", str);
+}
+
+TEST(CoverageRecordWriterTest, WriteEmpty) {
+  TestCoverageData coverage;
+  EXPECT_EQ("", WriteRecords(coverage, 4));
+}
+
+TEST(CoverageRecordWriterTest, WriteIsInOrder) {
+  TestCoverageData coverage;
+  coverage.InitDummyData(3);
+  EXPECT_EQ("file00000.cc 3:0\n"
+            "file00001.cc 3:1 6:2\n"
+            "file00002.cc 3:2 6:4 9:6\n",
+            WriteRecords(coverage, 1));
+}
+
+TEST(CoverageRecordWriterTest, ParallelWriteMatchesSerialWrite) {
+  // Enough source files to span several batches.
+  TestCoverageData coverage;
+  coverage.InitDummyData(10000);
+
+  std::string serial = WriteRecords(coverage, 1);
+  EXPECT_FALSE(serial.empty());
+  EXPECT_EQ(serial, WriteRecords(coverage, 4));
+  EXPECT_EQ(serial, WriteRecords(coverage, 13));
+}
+
+}  // namespace grinder
@@ -0,0 +1,536 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/grinder/function_table.h"
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "syzygy/common/binary_stream.h"
+#include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_reader.h"
+#include "syzygy/pdb/pdb_stream_reader.h"
+#include "syzygy/pdb/pdb_string_table.h"
+#include "syzygy/pdb/pdb_symbol_record.h"
+#include "syzygy/pe/cvinfo_ext.h"
+
+namespace grinder {
+
+namespace cci = Microsoft_Cci_Pdb;
+
+namespace {
+
+typedef FunctionTable::Function Function;
+typedef FunctionTable::Line Line;
+
+// The line numbers the compiler uses to hide code from the debugger.
+const size_t kFirstHiddenLineNumber = 0xF00F00;
+
+// Orders functions and lines by their address in the original image.
+template <typename ElementType>
+bool OriginalRvaLess(const ElementType& element1,
+                     const ElementType& element2) {
+  return element1.original_rva < element2.original_rva;
+}
+
+// Finds the last element of a vector sorted by original_rva that starts at
+// or before @p original_rva.
+template <typename ElementType>
+const ElementType* FindPreceding(const std::vector<ElementType>& elements,
+                                 core::RelativeAddress original_rva) {
+  typename std::vector<ElementType>::const_iterator it = std::upper_bound(
+      elements.begin(), elements.end(), original_rva,
+      [](core::RelativeAddress rva, const ElementType& element) {
+        return rva < element.original_rva;
+      });
+  if (it == elements.begin())
+    return NULL;
+  --it;
+  return &(*it);
+}
+
+// Reads the fixed part of a symbol, followed by its zero-terminated name.
+template <typename SymbolType>
+bool ReadNamedSymbol(size_t name_offset,
+                     common::BinaryStreamReader* reader,
+                     SymbolType* symbol,
+                     std::string* name) {
+  DCHECK(reader != NULL);
+  DCHECK(symbol != NULL);
+  DCHECK(name != NULL);
+
+  common::BinaryStreamParser parser(reader);
+  if (!parser.ReadBytes(name_offset, symbol) || !parser.ReadString(name)) {
+    LOG(ERROR) << "Unable to read symbol.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+struct FunctionTable::ReadContext {
+  pdb::PdbFile pdb_file;
+  pdb::DbiStream dbi_stream;
+
+  // The section headers of the original image.
+  std::vector<IMAGE_SECTION_HEADER> section_headers;
+
+  // The /names stream, holding the names of the source files.
+  pdb::PdbStringTable names;
+
+  // Maps the names of the source files to their index in source_files_.
+  std::map<std::string, size_t> source_file_indices;
+};
+
+bool FunctionTable::Init(const base::FilePath& pdb_path) {
+  DCHECK(functions_.empty());
+
+  ReadContext context;
+  pdb::PdbReader pdb_reader;
+  if (!pdb_reader.ReadMapped(pdb_path, &context.pdb_file)) {
+    LOG(ERROR) << "Failed to load PDB: " << pdb_path.value();
+    return false;
+  }
+
+  scoped_refptr<pdb::PdbStream> dbi_stream =
+      context.pdb_file.GetStream(pdb::kDbiStream);
+  if (dbi_stream.get() == NULL || !context.dbi_stream.Init(dbi_stream.get()) ||
+      !context.dbi_stream.ReadModules()) {
+    LOG(ERROR) << "Unable to read the Dbi stream of PDB: " << pdb_path.value();
+    return false;
+  }
+
+  if (!ReadSectionHeaders(&context))
+    return false;
+
+  // Both OMAP tables are needed: addresses of the module are looked up in the
+  // original image, and functions are reported at their address in the
+  // module.
+  if (context.dbi_stream.dbg_header().omap_from_src >= 0) {
+    std::vector<OMAP> omap_to;
+    std::vector<OMAP> omap_from;
+    if (!pdb::ReadOmapsFromPdbFile(context.pdb_file, &omap_to, &omap_from)) {
+      LOG(ERROR) << "Failed to read the OMAP data of PDB: "
+                 << pdb_path.value();
+      return false;
+    }
+    omap_to_.Init(omap_to);
+    omap_from_.Init(omap_from);
+  }
+
+  // The names of the source files are in the /names stream.
+  pdb::PdbNameStreamTable name_streams;
+  scoped_refptr<pdb::PdbStream> header_stream =
+      context.pdb_file.GetStream(pdb::kPdbHeaderInfoStream);
+  uint32_t names_stream_id = 0;
+  if (header_stream.get() != NULL && name_streams.Init(header_stream.get()) &&
+      name_streams.FindStream("/names", &names_stream_id)) {
+    scoped_refptr<pdb::PdbStream> names_stream =
+        context.pdb_file.GetStream(names_stream_id);
+    if (names_stream.get() == NULL ||
+        !context.names.Init(names_stream.get(), 0, names_stream->length())) {
+      LOG(ERROR) << "Unable to read the name table of PDB: "
+                 << pdb_path.value();
+      return false;
+    }
+  }
+
+  const pdb::DbiStream::DbiModuleVector& modules =
+      context.dbi_stream.modules();
+  for (size_t i = 0; i < modules.size(); ++i) {
+    if (!ReadModule(modules[i], &context)) {
+      LOG(ERROR) << "Unable to read module \"" << modules[i].module_name()
+                 << "\" of PDB: " << pdb_path.value();
+      return false;
+    }
+  }
+
+  if (!ReadPublicSymbols(&context)) {
+    LOG(ERROR) << "Unable to read the public symbols of PDB: "
+               << pdb_path.value();
+    return false;
+  }
+
+  std::sort(functions_.begin(), functions_.end(), OriginalRvaLess<Function>);
+  std::sort(public_functions_.begin(), public_functions_.end(),
+            OriginalRvaLess<Function>);
+  std::sort(lines_.begin(), lines_.end(), OriginalRvaLess<Line>);
+
+  return true;
+}
+
+const Function* FunctionTable::FindFunction(RelativeAddress rva) const {
+  return FindOriginalFunction(ToOriginal(rva));
+}
+
+void FunctionTable::FindFunctions(
+    const std::vector<RelativeAddress>& rvas,
+    std::vector<const Function*>* functions) const {
+  DCHECK(functions != NULL);
+
+  // Sort the addresses of the original image, remembering where each came
+  // from.
+  std::vector<std::pair<RelativeAddress, size_t>> original_rvas;
+  original_rvas.reserve(rvas.size());
+  for (size_t i = 0; i < rvas.size(); ++i)
+    original_rvas.push_back(std::make_pair(ToOriginal(rvas[i]), i));
+  std::sort(original_rvas.begin(), original_rvas.end());
+
+  // Sweep the sorted addresses against the private functions, keeping track
+  // of the last that starts at or before the current address.
+  functions->assign(rvas.size(), NULL);
+  Functions::const_iterator function_it = functions_.begin();
+  const Function* preceding = NULL;
+  for (size_t i = 0; i < original_rvas.size(); ++i) {
+    RelativeAddress original_rva = original_rvas[i].first;
+    for (; function_it != functions_.end() &&
+               function_it->original_rva <= original_rva;
+         ++function_it) {
+      preceding = &(*function_it);
+    }
+
+    const Function* function = NULL;
+    if (preceding != NULL &&
+        original_rva < preceding->original_rva + preceding->length) {
+      function = preceding;
+    } else {
+      // The public symbols are only looked at for the few addresses that
+      // have no private function.
+      function = FindPreceding(public_functions_, original_rva);
+    }
+    (*functions)[original_rvas[i].second] = function;
+  }
+}
+
+const Line* FunctionTable::FindLine(RelativeAddress rva) const {
+  RelativeAddress original_rva = ToOriginal(rva);
+  const Line* line = FindPreceding(lines_, original_rva);
+  if (line == NULL || original_rva >= line->original_rva + line->length)
+    return NULL;
+  return line;
+}
+
+bool FunctionTable::ReadSectionHeaders(ReadContext* context) {
+  DCHECK(context != NULL);
+
+  // Symbols refer to the sections of the original image. If the image was
+  // rewritten post-link, their headers may have been moved aside.
+  const pdb::DbiDbgHeader& dbg_header = context->dbi_stream.dbg_header();
+  int16_t stream_id = dbg_header.section_header_origin >= 0 ?
+      dbg_header.section_header_origin : dbg_header.section_header;
+  if (stream_id < 0) {
+    LOG(ERROR) << "No section header stream.";
+    return false;
+  }
+
+  scoped_refptr<pdb::PdbStream> stream =
+      context->pdb_file.GetStream(stream_id);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "Failed to get the section header stream.";
+    return false;
+  }
+
+  size_t num_sections = stream->length() / sizeof(IMAGE_SECTION_HEADER);
+  context->section_headers.resize(num_sections);
+  if (num_sections != 0 &&
+      !stream->ReadBytesAt(0, num_sections * sizeof(IMAGE_SECTION_HEADER),
+                           &context->section_headers.at(0))) {
+    LOG(ERROR) << "Failed to read the section header stream.";
+    return false;
+  }
+
+  return true;
+}
+
+bool FunctionTable::ReadModule(const pdb::DbiModuleInfo& module,
+                               ReadContext* context) {
+  DCHECK(context != NULL);
+
+  const pdb::DbiModuleInfoBase& module_info = module.module_info_base();
+  if (module_info.stream < 0)
+    return true;
+
+  scoped_refptr<pdb::PdbStream> stream =
+      context->pdb_file.GetStream(module_info.stream);
+  size_t lines_start = module_info.symbol_bytes + module_info.old_lines_bytes;
+  if (stream.get() == NULL ||
+      stream->length() < lines_start + module_info.lines_bytes) {
+    LOG(ERROR) << "Unable to open the symbol stream.";
+    return false;
+  }
+
+  // Gather the functions.
+  if (module_info.symbol_bytes != 0) {
+    pdb::VisitSymbolsCallback callback = base::Bind(
+        &FunctionTable::VisitModuleSymbol, base::Unretained(this),
+        base::Unretained(context));
+    if (!pdb::VisitSymbols(callback, 0, module_info.symbol_bytes, true,
+                           stream.get())) {
+      return false;
+    }
+  }
+
+  // Gather the lines.
+  return ReadLines(stream.get(), lines_start, module_info.lines_bytes,
+                   context);
+}
+
+bool FunctionTable::ReadLines(pdb::PdbStream* stream,
+                              size_t lines_start,
+                              size_t lines_size,
+                              ReadContext* context) {
+  DCHECK(stream != NULL);
+  DCHECK(context != NULL);
+
+  if (lines_size == 0)
+    return true;
+
+  // The line information is a run of {type, length} prefixed subsections.
+  // The DEBUG_S_LINES subsections refer to source files by the offset of
+  // their entry in the DEBUG_S_FILECHKSMS subsection, which may come after
+  // them, so the subsections are located first.
+  struct Subsection {
+    uint32_t type;
+    size_t start;
+    size_t length;
+  };
+  std::vector<Subsection> subsections;
+  const Subsection* checksums = NULL;
+  {
+    pdb::PdbStreamReaderWithPosition reader(lines_start, lines_size, stream);
+    common::BinaryStreamParser parser(&reader);
+    while (!reader.AtEnd()) {
+      Subsection subsection = {};
+      uint32_t length = 0;
+      if (!parser.Read(&subsection.type) || !parser.Read(&length)) {
+        LOG(ERROR) << "Unable to read line info subsection header.";
+        return false;
+      }
+      subsection.start = lines_start + reader.Position();
+      subsection.length = length;
+      if (!reader.Consume(length) || !parser.AlignTo(4)) {
+        LOG(ERROR) << "Unable to skip line info subsection.";
+        return false;
+      }
+      subsections.push_back(subsection);
+    }
+  }
+  for (size_t i = 0; i < subsections.size(); ++i) {
+    if (subsections[i].type == cci::DEBUG_S_FILECHKSMS)
+      checksums = &subsections[i];
+  }
+  if (checksums == NULL)
+    return true;
+
+  // Map the offsets of the file checksums to our source files.
+  std::map<size_t, size_t> file_indices;
+  {
+    pdb::PdbStreamReaderWithPosition reader(checksums->start,
+                                             checksums->length, stream);
+    common::BinaryStreamParser parser(&reader);
+    while (!reader.AtEnd()) {
+      size_t offset = reader.Position();
+      cci::CV_FileCheckSum checksum = {};
+      if (!parser.Read(&checksum) || !reader.Consume(checksum.len) ||
+          !parser.AlignTo(4)) {
+        LOG(ERROR) << "Unable to read file checksum.";
+        return false;
+      }
+
+      base::StringPiece name;
+      if (!context->names.GetString(checksum.name, &name)) {
+        LOG(ERROR) << "Unable to find the name of a source file.";
+        return false;
+      }
+      std::pair<std::map<std::string, size_t>::iterator, bool> result =
+          context->source_file_indices.insert(
+              std::make_pair(name.as_string(), source_files_.size()));
+      if (result.second)
+        source_files_.push_back(name.as_string());
+      file_indices[offset] = result.first->second;
+    }
+  }
+
+  for (size_t i = 0; i < subsections.size(); ++i) {
+    if (subsections[i].type != cci::DEBUG_S_LINES)
+      continue;
+
+    pdb::PdbStreamReaderWithPosition reader(subsections[i].start,
+                                             subsections[i].length, stream);
+    common::BinaryStreamParser parser(&reader);
+    cci::CV_LineSection line_section = {};
+    if (!parser.Read(&line_section)) {
+      LOG(ERROR) << "Unable to read line section.";
+      return false;
+    }
+    RelativeAddress section_start;
+    if (!GetOriginalAddress(*context, line_section.sec, line_section.off,
+                            &section_start)) {
+      continue;
+    }
+
+    while (!reader.AtEnd()) {
+      cci::CV_SourceFile source_file = {};
+      std::vector<cci::CV_Line> lines;
+      if (!parser.Read(&source_file) ||
+          !parser.ReadMultiple(source_file.count, &lines)) {
+        LOG(ERROR) << "Unable to read line records.";
+        return false;
+      }
+      if ((line_section.flags & cci::CV_LINES_HAVE_COLUMNS) != 0 &&
+          !reader.Consume(source_file.count * sizeof(cci::CV_Column))) {
+        LOG(ERROR) << "Unable to skip column records.";
+        return false;
+      }
+
+      std::map<size_t, size_t>::const_iterator file_it =
+          file_indices.find(source_file.index);
+      if (file_it == file_indices.end()) {
+        LOG(ERROR) << "Line records refer to an unknown source file.";
+        return false;
+      }
+
+      // Each line runs up to the next one, and the last one up to the end of
+      // the section.
+      for (size_t j = 0; j < lines.size(); ++j) {
+        uint32_t end = j + 1 < lines.size() ? lines[j + 1].offset :
+            line_section.cod;
+        size_t line_number = lines[j].flags & cci::linenumStart;
+        if (line_number >= kFirstHiddenLineNumber || end <= lines[j].offset)
+          continue;
+
+        Line line = {};
+        line.original_rva = section_start + lines[j].offset;
+        line.length = end - lines[j].offset;
+        line.source_file = file_it->second;
+        line.line_number = line_number;
+        lines_.push_back(line);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool FunctionTable::ReadPublicSymbols(ReadContext* context) {
+  DCHECK(context != NULL);
+
+  int16_t stream_id = context->dbi_stream.header().symbol_record_stream;
+  if (stream_id < 0)
+    return true;
+
+  scoped_refptr<pdb::PdbStream> stream =
+      context->pdb_file.GetStream(stream_id);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "Failed to get the symbol record stream.";
+    return false;
+  }
+
+  pdb::VisitSymbolsCallback callback = base::Bind(
+      &FunctionTable::VisitPublicSymbol, base::Unretained(this),
+      base::Unretained(context));
+  return pdb::VisitSymbols(callback, 0, stream->length(), false,
+                           stream.get());
+}
+
+bool FunctionTable::VisitModuleSymbol(ReadContext* context,
+                                      uint16_t symbol_length,
+                                      uint16_t symbol_type,
+                                      common::BinaryStreamReader* reader) {
+  DCHECK(context != NULL);
+  DCHECK(reader != NULL);
+
+  if (symbol_type != cci::S_GPROC32 && symbol_type != cci::S_LPROC32 &&
+      symbol_type != cci::S_GPROC32_VS2013 &&
+      symbol_type != cci::S_LPROC32_VS2013) {
+    return true;
+  }
+
+  cci::ProcSym32 proc = {};
+  Function function = {};
+  if (!ReadNamedSymbol(offsetof(cci::ProcSym32, name), reader, &proc,
+                       &function.name)) {
+    return false;
+  }
+  if (!GetOriginalAddress(*context, proc.seg, proc.off,
+                          &function.original_rva)) {
+    return true;
+  }
+  function.rva = omap_from_.empty() ? function.original_rva :
+      omap_from_.Translate(function.original_rva);
+  function.length = proc.len;
+  functions_.push_back(function);
+  return true;
+}
+
+bool FunctionTable::VisitPublicSymbol(ReadContext* context,
+                                      uint16_t symbol_length,
+                                      uint16_t symbol_type,
+                                      common::BinaryStreamReader* reader) {
+  DCHECK(context != NULL);
+  DCHECK(reader != NULL);
+
+  if (symbol_type != cci::S_PUB32)
+    return true;
+
+  cci::PubSym32 pub = {};
+  Function function = {};
+  if (!ReadNamedSymbol(offsetof(cci::PubSym32, name), reader, &pub,
+                       &function.name)) {
+    return false;
+  }
+  if ((pub.flags & cci::fFunction) == 0 ||
+      !GetOriginalAddress(*context, pub.seg, pub.off,
+                          &function.original_rva)) {
+    return true;
+  }
+  function.rva = omap_from_.empty() ? function.original_rva :
+      omap_from_.Translate(function.original_rva);
+  public_functions_.push_back(function);
+  return true;
+}
+
+bool FunctionTable::GetOriginalAddress(const ReadContext& context,
+                                       uint16_t section,
+                                       uint32_t offset,
+                                       RelativeAddress* rva) const {
+  DCHECK(rva != NULL);
+
+  // Sections are numbered from 1 to n in the PDB.
+  if (section == 0 || section > context.section_headers.size())
+    return false;
+  *rva = RelativeAddress(
+      context.section_headers[section - 1].VirtualAddress + offset);
+  return true;
+}
+
+FunctionTable::RelativeAddress FunctionTable::ToOriginal(
+    RelativeAddress rva) const {
+  if (omap_to_.empty())
+    return rva;
+  return omap_to_.Translate(rva);
+}
+
+const Function* FunctionTable::FindOriginalFunction(
+    RelativeAddress original_rva) const {
+  const Function* function = FindPreceding(functions_, original_rva);
+  if (function != NULL &&
+      original_rva < function->original_rva + function->length) {
+    return function;
+  }
+  return FindPreceding(public_functions_, original_rva);
+}
+
+}  // namespace grinder
@@ -0,0 +1,172 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares FunctionTable, a class holding the functions and source lines of a
+// module as read straight from its PDB, without going through DIA. The table
+// is built once, sorted by address, so that looking up the function or the
+// line of an address is a binary search, and looking up a sorted batch of
+// addresses is a single sweep of the table.
+
+#ifndef SYZYGY_GRINDER_FUNCTION_TABLE_H_
+#define SYZYGY_GRINDER_FUNCTION_TABLE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "syzygy/common/binary_stream.h"
+#include "syzygy/core/address.h"
+#include "syzygy/pdb/omap.h"
+#include "syzygy/pdb/pdb_dbi_stream.h"
+#include "syzygy/pdb/pdb_file.h"
+
+namespace grinder {
+
+// Holds the functions and source lines of a module. The private functions are
+// read from the symbol streams of the compilands, and the public function
+// symbols stand in for the functions that have no private symbol. If the
+// module was rewritten post-link, the addresses are translated through the
+// OMAP information of its PDB, as DIA would.
+class FunctionTable {
+ public:
+  typedef core::RelativeAddress RelativeAddress;
+
+  // A function of the module.
+  struct Function {
+    // The address of the function in the module.
+    RelativeAddress rva;
+    // The address of the function in the original image. This is the same as
+    // rva unless the module was rewritten post-link.
+    RelativeAddress original_rva;
+    // The length of the function in the original image. This is zero for
+    // public symbols, which cover the addresses up to the next one.
+    size_t length;
+    // The name of the function.
+    std::string name;
+  };
+
+  // The code bytes of a source line.
+  struct Line {
+    // The address of the first code byte, in the original image.
+    RelativeAddress original_rva;
+    // The number of code bytes.
+    size_t length;
+    // The index of the source file in source_files().
+    size_t source_file;
+    // The line number.
+    size_t line_number;
+  };
+
+  typedef std::vector<Function> Functions;
+  typedef std::vector<Line> Lines;
+  typedef std::vector<std::string> SourceFiles;
+
+  FunctionTable() { }
+
+  // Initializes this table with the functions and lines of a PDB.
+  // @param pdb_path the PDB to read.
+  // @returns true on success, false otherwise.
+  bool Init(const base::FilePath& pdb_path);
+
+  // Finds the function containing an address.
+  // @param rva the address of the module to look up.
+  // @returns the function containing @p rva, or NULL if there is none.
+  const Function* FindFunction(RelativeAddress rva) const;
+
+  // Finds the functions containing a batch of addresses. This sorts the
+  // addresses, and sweeps them against the table at once.
+  // @param rvas the addresses of the module to look up.
+  // @param functions receives the function containing each of @p rvas, or
+  //     NULL for those that have none, in the order of @p rvas.
+  void FindFunctions(const std::vector<RelativeAddress>& rvas,
+                     std::vector<const Function*>* functions) const;
+
+  // Finds the source line containing an address.
+  // @param rva the address of the module to look up.
+  // @returns the line containing @p rva, or NULL if there is none.
+  const Line* FindLine(RelativeAddress rva) const;
+
+  // @name Accessors.
+  // @{
+  // The private functions, sorted by original_rva.
+  const Functions& functions() const { return functions_; }
+  // The public function symbols, sorted by original_rva.
+  const Functions& public_functions() const { return public_functions_; }
+  // The source lines, sorted by original_rva.
+  const Lines& lines() const { return lines_; }
+  const SourceFiles& source_files() const { return source_files_; }
+  // @}
+
+ protected:
+  // The state of the reading of a PDB.
+  struct ReadContext;
+
+  // @name Helpers for Init.
+  // @{
+  bool ReadSectionHeaders(ReadContext* context);
+  bool ReadModule(const pdb::DbiModuleInfo& module, ReadContext* context);
+  bool ReadLines(pdb::PdbStream* stream,
+                 size_t lines_start,
+                 size_t lines_size,
+                 ReadContext* context);
+  bool ReadPublicSymbols(ReadContext* context);
+  // @}
+
+  // @name VisitSymbols callbacks, gathering the functions of the symbol
+  //     streams of the compilands and of the public symbol stream.
+  // @{
+  bool VisitModuleSymbol(ReadContext* context,
+                         uint16_t symbol_length,
+                         uint16_t symbol_type,
+                         common::BinaryStreamReader* reader);
+  bool VisitPublicSymbol(ReadContext* context,
+                         uint16_t symbol_length,
+                         uint16_t symbol_type,
+                         common::BinaryStreamReader* reader);
+  // @}
+
+  // Translates a section and offset pair to an address of the original
+  // image.
+  // @returns true if @p section is a valid section index, false otherwise.
+  bool GetOriginalAddress(const ReadContext& context,
+                          uint16_t section,
+                          uint32_t offset,
+                          RelativeAddress* rva) const;
+
+  // Translates an address of the module to the original image.
+  RelativeAddress ToOriginal(RelativeAddress rva) const;
+
+  // Finds the function containing an address of the original image.
+  const Function* FindOriginalFunction(RelativeAddress original_rva) const;
+
+  Functions functions_;
+  Functions public_functions_;
+  Lines lines_;
+  SourceFiles source_files_;
+
+  // The OMAP information translating between the addresses of the module
+  // and those of the original image. Both are empty if the module wasn't
+  // rewritten post-link.
+  pdb::OmapIndex omap_to_;
+  pdb::OmapIndex omap_from_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FunctionTable);
+};
+
+}  // namespace grinder
+
+#endif  // SYZYGY_GRINDER_FUNCTION_TABLE_H_
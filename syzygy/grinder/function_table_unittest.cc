@@ -0,0 +1,96 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/grinder/function_table.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/pe/unittest_util.h"
+
+namespace grinder {
+
+namespace {
+
+class FunctionTableTest : public testing::PELibUnitTest {
+ public:
+  void InitTable(const wchar_t* pdb_name) {
+    ASSERT_TRUE(table_.Init(testing::GetExeTestDataRelativePath(pdb_name)));
+    ASSERT_FALSE(table_.functions().empty());
+  }
+
+  FunctionTable table_;
+};
+
+}  // namespace
+
+TEST_F(FunctionTableTest, InitFailsForMissingPdb) {
+  EXPECT_FALSE(table_.Init(base::FilePath(L"nonexistent_pdb_file.pdb")));
+}
+
+TEST_F(FunctionTableTest, FindFunction) {
+  ASSERT_NO_FATAL_FAILURE(InitTable(testing::kTestDllPdbName));
+
+  const FunctionTable::Functions& functions = table_.functions();
+  for (size_t i = 0; i < functions.size(); ++i) {
+    const FunctionTable::Function& function = functions[i];
+    EXPECT_EQ(function.rva, function.original_rva);
+    EXPECT_EQ(&function, table_.FindFunction(function.rva));
+    if (function.length > 1) {
+      EXPECT_EQ(&function,
+                table_.FindFunction(function.rva + function.length - 1));
+    }
+  }
+
+  // There is no code at the start of the image.
+  EXPECT_EQ(NULL, table_.FindFunction(core::RelativeAddress(0)));
+}
+
+TEST_F(FunctionTableTest, FindFunctionsMatchesFindFunction) {
+  ASSERT_NO_FATAL_FAILURE(
+      InitTable(testing::kProfileInstrumentedTestDllPdbName));
+
+  // Look up the functions backwards, which exercises the sorting.
+  std::vector<core::RelativeAddress> rvas;
+  const FunctionTable::Functions& functions = table_.functions();
+  for (size_t i = functions.size(); i > 0; --i)
+    rvas.push_back(functions[i - 1].rva);
+  rvas.push_back(core::RelativeAddress(0));
+
+  std::vector<const FunctionTable::Function*> found;
+  table_.FindFunctions(rvas, &found);
+  ASSERT_EQ(rvas.size(), found.size());
+  for (size_t i = 0; i < rvas.size(); ++i)
+    EXPECT_EQ(table_.FindFunction(rvas[i]), found[i]);
+  EXPECT_EQ(NULL, found.back());
+}
+
+TEST_F(FunctionTableTest, FindLine) {
+  ASSERT_NO_FATAL_FAILURE(InitTable(testing::kTestDllPdbName));
+  ASSERT_FALSE(table_.lines().empty());
+  ASSERT_FALSE(table_.source_files().empty());
+
+  size_t num_found = 0;
+  const FunctionTable::Functions& functions = table_.functions();
+  for (size_t i = 0; i < functions.size(); ++i) {
+    const FunctionTable::Line* line = table_.FindLine(functions[i].rva);
+    if (line == NULL)
+      continue;
+    ++num_found;
+    EXPECT_LT(line->source_file, table_.source_files().size());
+    EXPECT_NE(0U, line->line_number);
+  }
+  EXPECT_NE(0U, num_found);
+}
+
+}  // namespace grinder
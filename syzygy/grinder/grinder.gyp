@@ -27,8 +27,12 @@
         'cache_grind_writer.h',
         'coverage_data.cc',
         'coverage_data.h',
+        'coverage_record_writer.cc',
+        'coverage_record_writer.h',
         'find.cc',
         'find.h',
+        'function_table.cc',
+        'function_table.h',
         'grinder_app.cc',
         'grinder_app.h',
         'grinder_util.cc',
@@ -40,6 +44,8 @@
         'lcov_writer.h',
         'line_info.cc',
         'line_info.h',
+        'parallel_parser.cc',
+        'parallel_parser.h',
         'grinders/coverage_grinder.cc',
         'grinders/coverage_grinder.h',
         'grinders/indexed_frequency_data_grinder.cc',
@@ -67,12 +73,15 @@
         'basic_block_util_unittest.cc',
         'cache_grind_writer_unittest.cc',
         'coverage_data_unittest.cc',
+        'coverage_record_writer_unittest.cc',
         'find_unittest.cc',
+        'function_table_unittest.cc',
         'grinder_app_unittest.cc',
         'grinder_util_unittest.cc',
         'indexed_frequency_data_serializer_unittest.cc',
         'lcov_writer_unittest.cc',
         'line_info_unittest.cc',
+        'parallel_parser_unittest.cc',
         'grinders/coverage_grinder_unittest.cc',
         'grinders/indexed_frequency_data_grinder_unittest.cc',
         'grinders/mem_replay_grinder_unittest.cc',
@@ -18,6 +18,8 @@
 #ifndef SYZYGY_GRINDER_GRINDER_H_
 #define SYZYGY_GRINDER_GRINDER_H_
 
+#include <memory>
+
 #include "base/command_line.h"
 #include "syzygy/trace/parse/parser.h"
 
@@ -43,6 +45,23 @@ class GrinderInterface : public trace::parser::ParseEventHandlerImpl {
   //     handler.
   virtual void SetParser(Parser* parser) = 0;
 
+  // Creates a worker grinder, configured like this one, to which the events of
+  // a share of the trace files are fed on a thread of its own. This will only
+  // be called after a successful call to ParseCommandLine, and prior to any
+  // parse event handling. The grinder itself is then fed no events, and the
+  // workers are merged back into it with MergeWorker before Grind is called.
+  // @returns the new worker, or NULL if this grinder doesn't support parsing
+  //     trace files in parallel.
+  virtual std::unique_ptr<GrinderInterface> CreateWorker() { return nullptr; }
+
+  // Merges the data aggregated by a worker into this grinder. This will only
+  // be called after all parse events have been handled by @p worker.
+  // @param worker a worker returned by CreateWorker. Its data may be moved
+  //     rather than copied.
+  // @returns true on success, false otherwise.
+  // @note The implementation should log on failure.
+  virtual bool MergeWorker(GrinderInterface* worker) { return false; }
+
   // Performs any computation/aggregation/summarization that needs to be done
   // after having parsed trace files. This will only be called after a
   // successful call to ParseCommandLine and after all parse events have been
@@ -16,6 +16,7 @@
 
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "syzygy/grinder/grinders/coverage_grinder.h"
@@ -23,6 +24,8 @@
 #include "syzygy/grinder/grinders/mem_replay_grinder.h"
 #include "syzygy/grinder/grinders/profile_grinder.h"
 #include "syzygy/grinder/grinders/sample_grinder.h"
+#include "syzygy/grinder/parallel_parser.h"
+#include "syzygy/pe/find.h"
 
 namespace grinder {
 
@@ -60,10 +63,30 @@ const char kUsageFormatStr[] =
     "Optional parameters\n"
     "  --output-file=<output file>\n"
     "    The location of output file. If not specified, output is to stdout.\n"
+    "  --find-cache=<path>\n"
+    "    A file caching the locations of the modules and PDBs found while\n"
+    "    processing the trace files. It is read if it exists, and updated\n"
+    "    once the data has been aggregated, so that later runs needn't\n"
+    "    search for them again.\n"
+    "  --threads=<n>\n"
+    "    The maximum number of threads on which to parse the trace files.\n"
+    "    Each trace file is parsed by a single thread. This is supported in\n"
+    "    all modes but 'memreplay'. In 'sample' mode the samples are also\n"
+    "    attributed to the heat map on as many threads. Defaults to 1.\n"
     "coverage mode optional parameters\n"
     "  --output-format=<output format>\n"
     "    Output format must be one of 'lcov' or 'cachegrind'. Defaults to\n"
     "    'lcov' if not explicitly specified.\n"
+    "  --coverage-snapshot=<path>\n"
+    "    A file accumulating the basic-block visit counts across runs. It is\n"
+    "    read if it exists, its counts are added to those of the trace\n"
+    "    files, and it is updated once the output has been written.\n"
+    "memreplay mode optional parameters\n"
+    "  --stream-window=<n>\n"
+    "    Grind the events as they are parsed, keeping only the <n> most\n"
+    "    recent events of each process in memory, and output the stories\n"
+    "    as a sequence of chunks. Events must arrive no later than <n>\n"
+    "    events after those that follow them.\n"
     "profile mode optional parameters\n"
     "  --thread-parts\n"
     "    Aggregate and output separate parts for each thread seen in the\n"
@@ -80,12 +103,16 @@ const char kUsageFormatStr[] =
     "    will be reported for all modules encountered in the trace files.\n"
     "    This must be specified for 'basic-block' aggregation modes, as\n"
     "    only one module may be processed at a time in this mode.\n"
+    "  --decomposition-cache=<dir>\n"
+    "    The directory of the decomposition cache shared with the other\n"
+    "    tools, through which the modules decomposed by an earlier run are\n"
+    "    read back. Defaults to the SYZYGY_DECOMPOSITION_CACHE variable.\n"
     "\n";
 
 }  // namespace
 
 GrinderApp::GrinderApp()
-    : application::AppImplBase("Grinder"), mode_() {
+    : application::AppImplBase("Grinder"), mode_(), num_threads_(1) {
 }
 
 void GrinderApp::PrintUsage(const base::FilePath& program,
@@ -157,7 +184,18 @@ bool GrinderApp::ParseCommandLine(const base::CommandLine* command_line) {
     return false;
   }
 
+  if (command_line->HasSwitch("threads")) {
+    std::string threads = command_line->GetSwitchValueASCII("threads");
+    if (!base::StringToSizeT(threads, &num_threads_) || num_threads_ == 0) {
+      PrintUsage(command_line->GetProgram(),
+                 base::StringPrintf("Invalid number of threads: %s.",
+                                    threads.c_str()));
+      return false;
+    }
+  }
+
   output_file_ = command_line->GetSwitchValuePath("output-file");
+  find_cache_path_ = command_line->GetSwitchValuePath("find-cache");
 
   return true;
 }
@@ -165,20 +203,6 @@ bool GrinderApp::ParseCommandLine(const base::CommandLine* command_line) {
 int GrinderApp::Run() {
   DCHECK(grinder_.get() != NULL);
 
-  trace::parser::Parser parser;
-  grinder_->SetParser(&parser);
-  if (!parser.Init(grinder_.get()))
-    return 1;
-
-  // Open the input files.
-  for (size_t i = 0; i < trace_files_.size(); ++i) {
-    if (!parser.OpenTraceFile(trace_files_[i])) {
-      LOG(ERROR) << "Unable to open trace file \'"
-                 << trace_files_[i].value() << "'";
-      return 1;
-    }
-  }
-
   // Open the output file. We do this early so as to fail before processing
   // the logs if the output is not able to be opened.
   FILE* output = out();
@@ -194,8 +218,14 @@ int GrinderApp::Run() {
     auto_close.reset(output);
   }
 
+  if (!find_cache_path_.empty() &&
+      !pe::FindCache::Get()->Load(find_cache_path_)) {
+    return 1;
+  }
+
   LOG(INFO) << "Parsing trace files.";
-  if (!parser.Consume()) {
+  ParallelParser parser(grinder_.get(), num_threads_);
+  if (!parser.Consume(trace_files_)) {
     LOG(ERROR) << "Error parsing trace files.";
     return 1;
   }
@@ -206,6 +236,12 @@ int GrinderApp::Run() {
     return 1;
   }
 
+  // A cache that can't be updated only costs later runs some time.
+  if (!find_cache_path_.empty() &&
+      !pe::FindCache::Get()->Save(find_cache_path_)) {
+    LOG(WARNING) << "Failed to update find cache.";
+  }
+
   std::wstring output_name(L"stdout");
   if (!output_file_.empty())
     output_name = base::StringPrintf(L"\"%ls\"", output_file_.value().c_str());
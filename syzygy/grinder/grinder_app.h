@@ -52,7 +52,9 @@ class GrinderApp : public application::AppImplBase {
  protected:
   std::vector<base::FilePath> trace_files_;
   base::FilePath output_file_;
+  base::FilePath find_cache_path_;
   Mode mode_;
+  size_t num_threads_;
   std::unique_ptr<GrinderInterface> grinder_;
 };
 
@@ -31,6 +31,8 @@ class TestGrinderApp : public GrinderApp {
   // Expose for testing.
   using GrinderApp::trace_files_;
   using GrinderApp::output_file_;
+  using GrinderApp::find_cache_path_;
+  using GrinderApp::num_threads_;
 };
 
 class GrinderAppTest : public testing::PELibUnitTest {
@@ -122,6 +124,39 @@ TEST_F(GrinderAppTest, ParseCommandLineOutputFile) {
   ASSERT_EQ(L"output.txt", impl_.output_file_.value());
 }
 
+TEST_F(GrinderAppTest, ParseCommandLineFindCache) {
+  ASSERT_TRUE(impl_.find_cache_path_.empty());
+  cmd_line_.AppendSwitchASCII("mode", "profile");
+  cmd_line_.AppendSwitchPath("find-cache", base::FilePath(L"cache.json"));
+  cmd_line_.AppendArgPath(testing::GetExeTestDataRelativePath(
+      testing::kProfileTraceFiles[0]));
+
+  ASSERT_TRUE(impl_.ParseCommandLine(&cmd_line_));
+  ASSERT_EQ(L"cache.json", impl_.find_cache_path_.value());
+}
+
+TEST_F(GrinderAppTest, ParseCommandLineThreads) {
+  cmd_line_.AppendSwitchASCII("mode", "coverage");
+  cmd_line_.AppendArgPath(testing::GetExeTestDataRelativePath(
+      testing::kCoverageTraceFiles[0]));
+
+  ASSERT_TRUE(impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(1u, impl_.num_threads_);
+
+  cmd_line_.AppendSwitchASCII("threads", "4");
+  ASSERT_TRUE(impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(4u, impl_.num_threads_);
+}
+
+TEST_F(GrinderAppTest, ParseCommandLineFailsWithNoThreads) {
+  cmd_line_.AppendSwitchASCII("mode", "coverage");
+  cmd_line_.AppendSwitchASCII("threads", "0");
+  cmd_line_.AppendArgPath(testing::GetExeTestDataRelativePath(
+      testing::kCoverageTraceFiles[0]));
+
+  ASSERT_FALSE(impl_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(GrinderAppTest, BasicBlockEntryEndToEnd) {
   cmd_line_.AppendSwitchASCII("mode", "bbentry");
   cmd_line_.AppendArgPath(testing::GetExeTestDataRelativePath(
@@ -195,6 +230,25 @@ TEST_F(GrinderAppTest, CoverageEndToEnd) {
   EXPECT_TRUE(base::PathExists(output_file));
 }
 
+TEST_F(GrinderAppTest, ParallelCoverageEndToEnd) {
+  cmd_line_.AppendSwitchASCII("mode", "coverage");
+  cmd_line_.AppendSwitchASCII("threads", "2");
+  for (size_t i = 0; i < arraysize(testing::kCoverageTraceFiles); ++i) {
+    cmd_line_.AppendArgPath(testing::GetExeTestDataRelativePath(
+        testing::kCoverageTraceFiles[i]));
+  }
+
+  base::FilePath output_file;
+  ASSERT_TRUE(base::CreateTemporaryFileInDir(temp_dir_, &output_file));
+  ASSERT_TRUE(base::DeleteFile(output_file, false));
+  cmd_line_.AppendSwitchPath("output-file", output_file);
+
+  EXPECT_EQ(0, app_.Run());
+
+  // Verify that the output file was created.
+  EXPECT_TRUE(base::PathExists(output_file));
+}
+
 TEST_F(GrinderAppTest, SampleEndToEnd) {
   base::FilePath trace_file = temp_dir_.Append(L"sampler.bin");
   ASSERT_NO_FATAL_FAILURE(testing::WriteDummySamplerTraceFile(trace_file));
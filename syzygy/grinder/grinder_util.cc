@@ -20,8 +20,10 @@
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/core/disassembler_util.h"
 #include "syzygy/pdb/omap.h"
+#include "syzygy/pdb/pdb_constants.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_reader.h"
+#include "syzygy/pdb/pdb_string_table.h"
 #include "syzygy/pdb/pdb_util.h"
 
 namespace grinder {
@@ -37,27 +39,28 @@ bool GetBasicBlockAddresses(const base::FilePath& pdb_path,
     return false;
   }
 
-  pdb::PdbInfoHeader70 pdb_header = {};
-  pdb::NameStreamMap name_stream_map;
-  if (!pdb::ReadHeaderInfoStream(pdb_file, &pdb_header, &name_stream_map)) {
+  scoped_refptr<pdb::PdbStream> header_stream =
+      pdb_file.GetStream(pdb::kPdbHeaderInfoStream);
+  pdb::PdbNameStreamTable name_stream_table;
+  if (header_stream.get() == NULL ||
+      !name_stream_table.Init(header_stream.get())) {
     LOG(ERROR) << "Failed to read PDB header info stream for PDB file: "
                << pdb_path.value();
     return false;
   }
 
-  pdb::NameStreamMap::const_iterator stream_id_it =
-      name_stream_map.find(common::kBasicBlockRangesStreamName);
-  if (stream_id_it == name_stream_map.end()) {
+  uint32_t stream_id = 0;
+  if (!name_stream_table.FindStream(common::kBasicBlockRangesStreamName,
+                                    &stream_id)) {
     LOG(ERROR) << "Failed to find stream \""
                << common::kBasicBlockRangesStreamName << "\" in PDB file: "
                << pdb_path.value();
     return false;
   }
 
-  scoped_refptr<pdb::PdbStream> stream =
-      pdb_file.GetStream(stream_id_it->second);
+  scoped_refptr<pdb::PdbStream> stream = pdb_file.GetStream(stream_id);
   if (stream.get() == NULL) {
-    LOG(ERROR) << "No stream with id " << stream_id_it->second
+    LOG(ERROR) << "No stream with id " << stream_id
                << " in PDB file: " << pdb_path.value();
     return false;
   }
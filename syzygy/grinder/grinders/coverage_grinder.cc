@@ -14,10 +14,16 @@
 
 #include "syzygy/grinder/grinders/coverage_grinder.h"
 
+#include <algorithm>
+#include <limits>
+#include <utility>
+
 #include "base/files/file_path.h"
+#include "base/files/file_util.h"
 #include "base/strings/string_util.h"
 #include "syzygy/common/indexed_frequency_data.h"
 #include "syzygy/grinder/cache_grind_writer.h"
+#include "syzygy/grinder/indexed_frequency_data_serializer.h"
 #include "syzygy/grinder/lcov_writer.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_util.h"
@@ -28,6 +34,11 @@ namespace grinders {
 
 namespace {
 
+using basic_block_util::EntryCountType;
+using basic_block_util::IndexedFrequencyInformation;
+using basic_block_util::IndexedFrequencyMap;
+using basic_block_util::IndexedFrequencyOffset;
+using basic_block_util::ModuleIndexedFrequencyMap;
 using basic_block_util::ModuleInformation;
 using basic_block_util::RelativeAddressRange;
 using basic_block_util::GetFrequency;
@@ -37,6 +48,17 @@ using basic_block_util::PdbInfo;
 using basic_block_util::PdbInfoMap;
 using trace::parser::AbsoluteAddress64;
 
+// Adds @p count to @p value using saturation arithmetic.
+void AddVisitCount(uint32_t count, EntryCountType* value) {
+  DCHECK(value != NULL);
+  const EntryCountType kMaxCount = std::numeric_limits<EntryCountType>::max();
+  if (count > static_cast<uint32_t>(kMaxCount - *value)) {
+    *value = kMaxCount;
+  } else {
+    *value += static_cast<EntryCountType>(count);
+  }
+}
+
 }  // namespace
 
 CoverageGrinder::CoverageGrinder()
@@ -51,20 +73,32 @@ CoverageGrinder::~CoverageGrinder() {
 bool CoverageGrinder::ParseCommandLine(const base::CommandLine* command_line) {
   DCHECK(command_line != NULL);
 
-  // If the switch isn't present we have nothing to do!
   const char kOutputFormat[] = "output-format";
-  if (!command_line->HasSwitch(kOutputFormat))
-    return true;
+  if (command_line->HasSwitch(kOutputFormat)) {
+    std::string format = command_line->GetSwitchValueASCII(kOutputFormat);
+    if (base::LowerCaseEqualsASCII(format, "lcov")) {
+      output_format_ = kLcovFormat;
+    } else if (base::LowerCaseEqualsASCII(format, "cachegrind")) {
+      output_format_ = kCacheGrindFormat;
+    } else {
+      LOG(ERROR) << "Unknown output format: " << format << ".";
+      return false;
+    }
+  }
 
-  std::string format = command_line->GetSwitchValueASCII(kOutputFormat);
-  if (base::LowerCaseEqualsASCII(format, "lcov")) {
-    output_format_ = kLcovFormat;
-  } else if (base::LowerCaseEqualsASCII(format, "cachegrind")) {
-    output_format_ = kCacheGrindFormat;
-  } else {
-    LOG(ERROR) << "Unknown output format: " << format << ".";
-    return false;
+  const char kCoverageSnapshot[] = "coverage-snapshot";
+  if (command_line->HasSwitch(kCoverageSnapshot)) {
+    snapshot_path_ = command_line->GetSwitchValuePath(kCoverageSnapshot);
+    if (snapshot_path_.empty()) {
+      LOG(ERROR) << "Must specify a path for --" << kCoverageSnapshot << ".";
+      return false;
+    }
+
+    // A missing snapshot is created from scratch.
+    if (base::PathExists(snapshot_path_) && !LoadSnapshot(snapshot_path_))
+      return false;
   }
+
   return true;
 }
 
@@ -73,6 +107,68 @@ void CoverageGrinder::SetParser(Parser* parser) {
   parser_ = parser;
 }
 
+std::unique_ptr<GrinderInterface> CoverageGrinder::CreateWorker() {
+  std::unique_ptr<CoverageGrinder> worker(new CoverageGrinder());
+  worker->output_format_ = output_format_;
+  worker->snapshot_path_ = snapshot_path_;
+  return std::move(worker);
+}
+
+bool CoverageGrinder::MergeWorker(GrinderInterface* worker) {
+  DCHECK(worker != NULL);
+  CoverageGrinder* coverage_worker = static_cast<CoverageGrinder*>(worker);
+
+  if (coverage_worker->event_handler_errored_)
+    event_handler_errored_ = true;
+
+  PdbInfoMap::iterator worker_it = coverage_worker->pdb_info_cache_.begin();
+  for (; worker_it != coverage_worker->pdb_info_cache_.end(); ++worker_it) {
+    PdbInfo& worker_pdb_info = worker_it->second;
+
+    // A cached failure of the worker adds nothing.
+    if (worker_pdb_info.pdb_path.empty())
+      continue;
+
+    // The PDB info of modules we haven't seen, or failed to load, is moved
+    // rather than copied, as the source lines of the line information point
+    // into its set of source file names.
+    PdbInfo& pdb_info = pdb_info_cache_[worker_it->first];
+    if (pdb_info.pdb_path.empty()) {
+      pdb_info.pdb_path = worker_pdb_info.pdb_path;
+      pdb_info.line_info = std::move(worker_pdb_info.line_info);
+      pdb_info.bb_ranges = std::move(worker_pdb_info.bb_ranges);
+      continue;
+    }
+
+    if (!pdb_info.line_info.AddVisits(worker_pdb_info.line_info)) {
+      LOG(ERROR) << "Failed to merge line information from PDB: "
+                 << pdb_info.pdb_path.value();
+      return false;
+    }
+  }
+
+  ModuleIndexedFrequencyMap::iterator counts_it =
+      coverage_worker->visit_counts_.begin();
+  for (; counts_it != coverage_worker->visit_counts_.end(); ++counts_it) {
+    ModuleIndexedFrequencyMap::iterator look =
+        visit_counts_.find(counts_it->first);
+    if (look == visit_counts_.end()) {
+      visit_counts_.insert(
+          std::make_pair(counts_it->first, std::move(counts_it->second)));
+      continue;
+    }
+
+    const IndexedFrequencyMap& worker_counts = counts_it->second.frequency_map;
+    IndexedFrequencyMap::const_iterator entry_it = worker_counts.begin();
+    for (; entry_it != worker_counts.end(); ++entry_it) {
+      AddVisitCount(entry_it->second,
+                    &look->second.frequency_map[entry_it->first]);
+    }
+  }
+
+  return true;
+}
+
 bool CoverageGrinder::Grind() {
   if (event_handler_errored_) {
     LOG(WARNING) << "Failed to handle all basic block frequency data events, "
@@ -118,6 +214,15 @@ bool CoverageGrinder::OutputData(FILE* file) {
     default: NOTREACHED() << "Unknown OutputFormat.";
   }
 
+  if (!snapshot_path_.empty()) {
+    IndexedFrequencyDataSerializer serializer;
+    if (!serializer.SaveAsJson(visit_counts_, snapshot_path_)) {
+      LOG(ERROR) << "Failed to write coverage snapshot: "
+                 << snapshot_path_.value();
+      return false;
+    }
+  }
+
   return true;
 }
 
@@ -185,17 +290,90 @@ void CoverageGrinder::OnIndexedFrequency(
     if (bb_freq == 0)
       continue;
 
-    // Mark this basic-block as visited.
-    const RelativeAddressRange& bb_range = pdb_info->bb_ranges[bb_index];
-    if (!pdb_info->line_info.Visit(bb_range.start(),
-                                   bb_range.size(),
-                                   bb_freq)) {
-      LOG(ERROR) << "Failed to visit BB at " << bb_range << ".";
+    if (!VisitBasicBlock(*module_info, pdb_info, bb_index, bb_freq)) {
       event_handler_errored_ = true;
       return;
     }
   }
 }
 
+bool CoverageGrinder::LoadSnapshot(const base::FilePath& snapshot_path) {
+  IndexedFrequencyDataSerializer serializer;
+  ModuleIndexedFrequencyMap snapshot;
+  if (!serializer.LoadFromJson(snapshot_path, &snapshot)) {
+    LOG(ERROR) << "Failed to load coverage snapshot: "
+               << snapshot_path.value();
+    return false;
+  }
+
+  ModuleIndexedFrequencyMap::const_iterator module_it = snapshot.begin();
+  for (; module_it != snapshot.end(); ++module_it) {
+    const ModuleInformation& module_info = module_it->first;
+    const IndexedFrequencyInformation& info = module_it->second;
+
+    // The snapshot needs the PDB of the module to be mapped back to lines.
+    PdbInfo* pdb_info = NULL;
+    if (!LoadPdbInfo(&pdb_info_cache_, module_info, &pdb_info)) {
+      LOG(ERROR) << "Failed to load the PDB info of snapshot module: "
+                 << module_info.path;
+      return false;
+    }
+    DCHECK(pdb_info != NULL);
+
+    if (info.num_entries != pdb_info->bb_ranges.size()) {
+      LOG(ERROR) << "Mismatch between snapshot BB count and PDB BB count for "
+                 << "module: " << module_info.path;
+      return false;
+    }
+
+    for (size_t bb_index = 0; bb_index < pdb_info->bb_ranges.size();
+         ++bb_index) {
+      IndexedFrequencyOffset offset(pdb_info->bb_ranges[bb_index].start(), 0);
+      IndexedFrequencyMap::const_iterator count_it =
+          info.frequency_map.find(offset);
+      if (count_it == info.frequency_map.end() || count_it->second <= 0)
+        continue;
+
+      if (!VisitBasicBlock(module_info, pdb_info, bb_index, count_it->second))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool CoverageGrinder::VisitBasicBlock(const ModuleInformation& module_info,
+                                      PdbInfo* pdb_info,
+                                      size_t bb_index,
+                                      uint32_t count) {
+  DCHECK(pdb_info != NULL);
+  DCHECK_LT(bb_index, pdb_info->bb_ranges.size());
+
+  // Mark this basic-block as visited.
+  const RelativeAddressRange& bb_range = pdb_info->bb_ranges[bb_index];
+  if (!pdb_info->line_info.Visit(bb_range.start(), bb_range.size(), count)) {
+    LOG(ERROR) << "Failed to visit BB at " << bb_range << ".";
+    return false;
+  }
+
+  if (snapshot_path_.empty())
+    return true;
+
+  // Record the visits in the snapshot.
+  ModuleIndexedFrequencyMap::iterator look = visit_counts_.find(module_info);
+  if (look == visit_counts_.end()) {
+    IndexedFrequencyInformation info = {};
+    info.num_entries = pdb_info->bb_ranges.size();
+    info.num_columns = 1;
+    info.frequency_size = sizeof(uint32_t);
+    info.data_type = common::IndexedFrequencyData::BASIC_BLOCK_ENTRY;
+    look = visit_counts_.insert(std::make_pair(module_info, info)).first;
+  }
+  IndexedFrequencyOffset offset(bb_range.start(), 0);
+  AddVisitCount(count, &look->second.frequency_map[offset]);
+
+  return true;
+}
+
 }  // namespace grinders
 }  // namespace grinder
@@ -26,6 +26,14 @@ namespace grinders {
 
 // This class processes trace files containing basic-block frequency data and
 // produces LCOV output.
+//
+// If --coverage-snapshot is included in the command line passed to
+// ParseCommandLine(), the basic-block visit counts of the snapshot it names
+// are loaded, if it exists, and accumulated with those of the trace files.
+// The snapshot is then rewritten with the updated counts by OutputData(), so
+// that the coverage of a series of runs can be ground incrementally. The
+// snapshot is keyed by the signatures of the instrumented modules, in the
+// JSON format of the IndexedFrequencyDataSerializer.
 class CoverageGrinder : public GrinderInterface {
  public:
   CoverageGrinder();
@@ -35,6 +43,8 @@ class CoverageGrinder : public GrinderInterface {
   // @{
   virtual bool ParseCommandLine(const base::CommandLine* command_line) override;
   virtual void SetParser(Parser* parser) override;
+  virtual std::unique_ptr<GrinderInterface> CreateWorker() override;
+  virtual bool MergeWorker(GrinderInterface* worker) override;
   virtual bool Grind() override;
   virtual bool OutputData(FILE* file) override;
   // @}
@@ -60,7 +70,30 @@ class CoverageGrinder : public GrinderInterface {
 
   const CoverageData& coverage_data() { return coverage_data_; }
 
+  // @returns the basic-block visit counts of the instrumented modules. These
+  //     are only gathered if a coverage snapshot was requested.
+  const basic_block_util::ModuleIndexedFrequencyMap& visit_counts() const {
+    return visit_counts_;
+  }
+
  protected:
+  // Loads the visit counts of a coverage snapshot, and visits the lines of
+  // their basic blocks.
+  // @param snapshot_path the path of the snapshot to load.
+  // @returns true on success, false otherwise.
+  bool LoadSnapshot(const base::FilePath& snapshot_path);
+
+  // Adds @p count visits to a basic block of a module.
+  // @param module_info the instrumented module being visited.
+  // @param pdb_info the PDB info of the module.
+  // @param bb_index the index of the basic block being visited.
+  // @param count the number of visits of the basic block.
+  // @returns true on success, false otherwise.
+  bool VisitBasicBlock(const basic_block_util::ModuleInformation& module_info,
+                       basic_block_util::PdbInfo* pdb_info,
+                       size_t bb_index,
+                       uint32_t count);
+
   // Stores per-module coverage data, populated during calls to
   // OnIndexedFrequency.
   basic_block_util::PdbInfoMap pdb_info_cache_;
@@ -80,6 +113,13 @@ class CoverageGrinder : public GrinderInterface {
 
   // The output format to use.
   OutputFormat output_format_;
+
+  // The coverage snapshot to accumulate into, if any.
+  base::FilePath snapshot_path_;
+
+  // Stores the basic-block visit counts per instrumented module, keyed by the
+  // start of the basic blocks, when a snapshot is to be written.
+  basic_block_util::ModuleIndexedFrequencyMap visit_counts_;
 };
 
 }  // namespace grinders
@@ -14,6 +14,7 @@
 
 #include "syzygy/grinder/grinders/coverage_grinder.h"
 
+#include "base/files/scoped_temp_dir.h"
 #include "base/win/scoped_com_initializer.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
@@ -129,5 +130,109 @@ TEST_F(CoverageGrinderTest, GrindAndOutputCacheGrindDataSucceeds) {
   // TODO(chrisha): Validate the output is a valid CacheGrind file.
 }
 
+TEST_F(CoverageGrinderTest, MergeWorkersMatchesSequentialParsing) {
+  // Grind two trace files with one grinder.
+  TestCoverageGrinder expected;
+  ASSERT_TRUE(expected.ParseCommandLine(&cmd_line_));
+  ASSERT_TRUE(parser_.Init(&expected));
+  for (size_t i = 0; i < 2; ++i) {
+    ASSERT_TRUE(parser_.OpenTraceFile(
+        testing::GetExeTestDataRelativePath(testing::kCoverageTraceFiles[i])));
+  }
+  expected.SetParser(&parser_);
+  ASSERT_TRUE(parser_.Consume());
+  ASSERT_TRUE(expected.Grind());
+
+  // Grind each of them with a worker of its own, and merge the workers.
+  TestCoverageGrinder grinder;
+  ASSERT_TRUE(grinder.ParseCommandLine(&cmd_line_));
+  for (size_t i = 0; i < 2; ++i) {
+    std::unique_ptr<GrinderInterface> worker(grinder.CreateWorker());
+    ASSERT_TRUE(worker.get() != NULL);
+
+    trace::parser::Parser parser;
+    ASSERT_TRUE(parser.Init(worker.get()));
+    ASSERT_TRUE(parser.OpenTraceFile(
+        testing::GetExeTestDataRelativePath(testing::kCoverageTraceFiles[i])));
+    worker->SetParser(&parser);
+    ASSERT_TRUE(parser.Consume());
+    EXPECT_TRUE(grinder.MergeWorker(worker.get()));
+  }
+  ASSERT_TRUE(grinder.Grind());
+
+  const CoverageData::SourceFileCoverageDataMap& expected_map =
+      expected.coverage_data().source_file_coverage_data_map();
+  const CoverageData::SourceFileCoverageDataMap& actual_map =
+      grinder.coverage_data().source_file_coverage_data_map();
+  ASSERT_EQ(expected_map.size(), actual_map.size());
+  CoverageData::SourceFileCoverageDataMap::const_iterator expected_it =
+      expected_map.begin();
+  CoverageData::SourceFileCoverageDataMap::const_iterator actual_it =
+      actual_map.begin();
+  for (; expected_it != expected_map.end(); ++expected_it, ++actual_it) {
+    EXPECT_EQ(expected_it->first, actual_it->first);
+    EXPECT_EQ(expected_it->second.line_execution_count_map,
+              actual_it->second.line_execution_count_map);
+  }
+}
+
+TEST_F(CoverageGrinderTest, SnapshotAccumulatesCoverage) {
+  // Grind two trace files with one grinder.
+  TestCoverageGrinder expected;
+  ASSERT_TRUE(expected.ParseCommandLine(&cmd_line_));
+  ASSERT_TRUE(parser_.Init(&expected));
+  for (size_t i = 0; i < 2; ++i) {
+    ASSERT_TRUE(parser_.OpenTraceFile(
+        testing::GetExeTestDataRelativePath(testing::kCoverageTraceFiles[i])));
+  }
+  expected.SetParser(&parser_);
+  ASSERT_TRUE(parser_.Consume());
+  ASSERT_TRUE(expected.Grind());
+
+  // Grind each of them on a run of its own, accumulating into a snapshot.
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath snapshot_path(temp_dir.path().Append(L"snapshot.json"));
+  cmd_line_.AppendSwitchPath("coverage-snapshot", snapshot_path);
+  for (size_t i = 0; i < 2; ++i) {
+    TestCoverageGrinder grinder;
+    ASSERT_TRUE(grinder.ParseCommandLine(&cmd_line_));
+
+    trace::parser::Parser parser;
+    ASSERT_TRUE(parser.Init(&grinder));
+    ASSERT_TRUE(parser.OpenTraceFile(
+        testing::GetExeTestDataRelativePath(testing::kCoverageTraceFiles[i])));
+    grinder.SetParser(&parser);
+    ASSERT_TRUE(parser.Consume());
+    ASSERT_TRUE(grinder.Grind());
+    EXPECT_FALSE(grinder.visit_counts().empty());
+
+    testing::ScopedTempFile output_path;
+    base::ScopedFILE output_file(base::OpenFile(output_path.path(), "wb"));
+    ASSERT_TRUE(output_file.get() != NULL);
+    EXPECT_TRUE(grinder.OutputData(output_file.get()));
+    EXPECT_TRUE(base::PathExists(snapshot_path));
+
+    if (i == 0)
+      continue;
+
+    // The last run has the coverage of both trace files.
+    const CoverageData::SourceFileCoverageDataMap& expected_map =
+        expected.coverage_data().source_file_coverage_data_map();
+    const CoverageData::SourceFileCoverageDataMap& actual_map =
+        grinder.coverage_data().source_file_coverage_data_map();
+    ASSERT_EQ(expected_map.size(), actual_map.size());
+    CoverageData::SourceFileCoverageDataMap::const_iterator expected_it =
+        expected_map.begin();
+    CoverageData::SourceFileCoverageDataMap::const_iterator actual_it =
+        actual_map.begin();
+    for (; expected_it != expected_map.end(); ++expected_it, ++actual_it) {
+      EXPECT_EQ(expected_it->first, actual_it->first);
+      EXPECT_EQ(expected_it->second.line_execution_count_map,
+                actual_it->second.line_execution_count_map);
+    }
+  }
+}
+
 }  // namespace grinders
 }  // namespace grinder
@@ -46,6 +46,64 @@ void IndexedFrequencyDataGrinder::SetParser(Parser* parser) {
   parser_ = parser;
 }
 
+std::unique_ptr<GrinderInterface> IndexedFrequencyDataGrinder::CreateWorker() {
+  std::unique_ptr<IndexedFrequencyDataGrinder> worker(
+      new IndexedFrequencyDataGrinder());
+  worker->serializer_.set_pretty_print(serializer_.pretty_print());
+  return std::move(worker);
+}
+
+bool IndexedFrequencyDataGrinder::MergeWorker(GrinderInterface* worker) {
+  using basic_block_util::EntryCountType;
+  using basic_block_util::IndexedFrequencyInformation;
+  using basic_block_util::IndexedFrequencyMap;
+
+  DCHECK(worker != NULL);
+  IndexedFrequencyDataGrinder* frequency_worker =
+      static_cast<IndexedFrequencyDataGrinder*>(worker);
+
+  if (frequency_worker->event_handler_errored_)
+    event_handler_errored_ = true;
+
+  ModuleIndexedFrequencyMap::iterator worker_it =
+      frequency_worker->frequency_data_map_.begin();
+  for (; worker_it != frequency_worker->frequency_data_map_.end();
+       ++worker_it) {
+    IndexedFrequencyInformation& worker_info = worker_it->second;
+
+    // The frequencies of modules we haven't seen are moved as a whole.
+    ModuleIndexedFrequencyMap::iterator look =
+        frequency_data_map_.find(worker_it->first);
+    if (look == frequency_data_map_.end()) {
+      frequency_data_map_.insert(
+          std::make_pair(worker_it->first, std::move(worker_info)));
+      continue;
+    }
+
+    // Validate fields are compatible to be grinded together.
+    IndexedFrequencyInformation& info = look->second;
+    if (info.num_entries != worker_info.num_entries ||
+        info.num_columns != worker_info.num_columns ||
+        info.frequency_size != worker_info.frequency_size ||
+        info.data_type != worker_info.data_type) {
+      LOG(ERROR) << "Inconsistent frequency data for module "
+                 << worker_it->first.path;
+      return false;
+    }
+
+    // Add the worker's frequencies using saturation arithmetic.
+    IndexedFrequencyMap::const_iterator entry_it =
+        worker_info.frequency_map.begin();
+    for (; entry_it != worker_info.frequency_map.end(); ++entry_it) {
+      EntryCountType& value = info.frequency_map[entry_it->first];
+      value += std::min(
+          entry_it->second, std::numeric_limits<EntryCountType>::max() - value);
+    }
+  }
+
+  return true;
+}
+
 bool IndexedFrequencyDataGrinder::Grind() {
   if (frequency_data_map_.empty()) {
     LOG(ERROR) << "No basic-block frequency data was encountered.";
@@ -47,6 +47,8 @@ class IndexedFrequencyDataGrinder : public GrinderInterface {
   // @{
   virtual bool ParseCommandLine(const base::CommandLine* command_line) override;
   virtual void SetParser(Parser* parser) override;
+  virtual std::unique_ptr<GrinderInterface> CreateWorker() override;
+  virtual bool MergeWorker(GrinderInterface* worker) override;
   virtual bool Grind() override;
   virtual bool OutputData(FILE* file) override;
   // @}
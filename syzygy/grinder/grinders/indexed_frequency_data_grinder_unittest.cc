@@ -292,6 +292,51 @@ TEST_F(IndexedFrequencyDataGrinderTest, UpdateBasicBlockFrequencyData) {
   }
 }
 
+TEST_F(IndexedFrequencyDataGrinderTest, MergeWorker) {
+  InstrumentedModuleInformation module_info;
+  ASSERT_NO_FATAL_FAILURE(InitModuleInfo(&module_info));
+  ScopedFrequencyData data;
+  ASSERT_NO_FATAL_FAILURE(GetFrequencyData(module_info.original_module,
+                                           4,
+                                           &data));
+
+  TestIndexedFrequencyDataGrinder grinder;
+  ASSERT_TRUE(grinder.ParseCommandLine(&cmd_line_));
+
+  // The data of a module the grinder hasn't seen is taken as is.
+  std::unique_ptr<GrinderInterface> worker(grinder.CreateWorker());
+  ASSERT_TRUE(worker.get() != NULL);
+  static_cast<TestIndexedFrequencyDataGrinder*>(worker.get())->
+      UpdateBasicBlockFrequencyData(module_info, data.get());
+  EXPECT_TRUE(grinder.MergeWorker(worker.get()));
+  IndexedFrequencyMap expected_counts;
+  EXPECT_EQ(1U, grinder.frequency_data_map().size());
+  CreateExpectedCounts(1, &expected_counts);
+  EXPECT_THAT(grinder.frequency_data_map().begin()->second.frequency_map,
+              testing::ContainerEq(expected_counts));
+
+  // The data of a module it has seen are added up.
+  worker = grinder.CreateWorker();
+  ASSERT_TRUE(worker.get() != NULL);
+  static_cast<TestIndexedFrequencyDataGrinder*>(worker.get())->
+      UpdateBasicBlockFrequencyData(module_info, data.get());
+  static_cast<TestIndexedFrequencyDataGrinder*>(worker.get())->
+      UpdateBasicBlockFrequencyData(module_info, data.get());
+  EXPECT_TRUE(grinder.MergeWorker(worker.get()));
+  EXPECT_EQ(1U, grinder.frequency_data_map().size());
+  CreateExpectedCounts(3, &expected_counts);
+  EXPECT_THAT(grinder.frequency_data_map().begin()->second.frequency_map,
+              testing::ContainerEq(expected_counts));
+
+  // Data of another type can't be merged.
+  data->data_type = common::IndexedFrequencyData::BASIC_BLOCK_ENTRY;
+  worker = grinder.CreateWorker();
+  ASSERT_TRUE(worker.get() != NULL);
+  static_cast<TestIndexedFrequencyDataGrinder*>(worker.get())->
+      UpdateBasicBlockFrequencyData(module_info, data.get());
+  EXPECT_FALSE(grinder.MergeWorker(worker.get()));
+}
+
 TEST_F(IndexedFrequencyDataGrinderTest, GrindBranchEntryDataSucceeds) {
   ModuleIndexedFrequencyMap entry_counts;
   ASSERT_NO_FATAL_FAILURE(
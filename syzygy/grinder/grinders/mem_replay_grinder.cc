@@ -14,8 +14,11 @@
 
 #include "syzygy/grinder/grinders/mem_replay_grinder.h"
 
+#include <algorithm>
 #include <cstring>
+#include <limits>
 
+#include "base/strings/string_number_conversions.h"
 #include "syzygy/bard/raw_argument_converter.h"
 #include "syzygy/bard/events/heap_alloc_event.h"
 #include "syzygy/bard/events/heap_create_event.h"
@@ -44,6 +47,15 @@ const char* kAsanHeapFunctionNames[] = {
 
 using RawArgumentConverters = std::vector<bard::RawArgumentConverter>;
 
+// The switch enabling streaming, and setting the size of the window.
+const char kStreamWindow[] = "stream-window";
+
+// The size of the buffer used to copy the streamed chunks to the output.
+const size_t kStreamCopyBufferSize = 64 * 1024;
+
+// A timestamp greater than those of all events.
+const uint64_t kMaxTimestamp = std::numeric_limits<uint64_t>::max();
+
 // A templated utility function for parsing a value from a buffer by copying
 // its contents.
 bool ParseUint32(const uint8_t* end, const uint8_t** cursor, uint32_t* value) {
@@ -192,7 +204,8 @@ class ArgumentParser {
 
 }  // namespace
 
-MemReplayGrinder::MemReplayGrinder() : parse_error_(false) {
+MemReplayGrinder::MemReplayGrinder()
+    : parse_error_(false), stream_window_(0), stream_chunk_count_(0) {
 }
 
 bool MemReplayGrinder::ParseCommandLine(
@@ -200,6 +213,28 @@ bool MemReplayGrinder::ParseCommandLine(
   DCHECK_NE(static_cast<base::CommandLine*>(nullptr), command_line);
   LoadAsanFunctionNames();
 
+  if (command_line->HasSwitch(kStreamWindow)) {
+    std::string window = command_line->GetSwitchValueASCII(kStreamWindow);
+    if (!base::StringToSizeT(window, &stream_window_) || stream_window_ == 0) {
+      LOG(ERROR) << "Invalid stream window: \"" << window << "\".";
+      return false;
+    }
+
+    if (!stream_dir_.CreateUniqueTempDir()) {
+      LOG(ERROR) << "Failed to create a directory for the stream.";
+      return false;
+    }
+    base::FilePath stream_path = stream_dir_.path().AppendASCII("chunks.bin");
+    stream_file_.reset(base::OpenFile(stream_path, "wb+"));
+    if (stream_file_.get() == nullptr) {
+      LOG(ERROR) << "Failed to create \"" << stream_path.value() << "\".";
+      return false;
+    }
+    stream_out_stream_.reset(new core::FileOutStream(stream_file_.get()));
+    stream_archive_.reset(
+        new core::NativeBinaryOutArchive(stream_out_stream_.get()));
+  }
+
   return true;
 }
 
@@ -233,63 +268,14 @@ bool MemReplayGrinder::Grind() {
     }
   }
 
-  // Grind each set of process data on its own.
+  // Grind each set of process data on its own. When streaming, this flushes
+  // the events remaining in the window.
   for (auto& proc : process_data_map_) {
-    // Make a heap of events across all threads in this process.
-    std::vector<ThreadDataIterator> heap;
-    for (auto& thread : proc.second.thread_data_map) {
-      if (thread.second.timestamps.empty())
-        continue;
-      ThreadDataIterator thread_it = {&thread.second, 0};
-      heap.push_back(thread_it);
-    }
-    std::make_heap(heap.begin(), heap.end());
-
-    // This is used to track known objects.
-    ObjectMap object_map;
-    // This is used to track synchronization points between threads.
-    WaitedMap waited_map;
-
-    // Prepopulate the object map with entries for all the process heaps that
-    // existed at process startup.
-    const ThreadDataIterator kDummyThreadDataIterator = {nullptr, 0};
-    const ObjectInfo kDummyObjectInfo(kDummyThreadDataIterator);
-    for (auto heap : proc.second.existing_heaps)
-      object_map.insert(std::make_pair(heap, kDummyObjectInfo));
-
-    // Process all of the thread events in the serial order in which they
-    // occurred. While doing so update object_map and waited_map, and encode
-    // dependencies in the underlying PlotLine structures.
-    while (!heap.empty()) {
-      std::pop_heap(heap.begin(), heap.end());
-      auto thread_it = heap.back();
-      heap.pop_back();
-
-      // Determine inputs and outputs of this event.
-      EventObjects objects;
-      GetEventObjects(thread_it, &objects);
-
-      // Determine input dependencies for this event.
-      Deps deps;
-      if (!GetDeps(thread_it, objects, object_map, &deps))
-        return false;
-
-      // Encode dependencies as explicit synchronization points as required,
-      // and update the |waited_map| with this information.
-      if (!ApplyDeps(thread_it, object_map, deps, &waited_map))
+    if (stream_window_ != 0) {
+      if (!FlushProcessData(true, &proc.second))
         return false;
-
-      // Update the object map to reflect objects that have been destroyed,
-      // created, or used.
-      if (!UpdateObjectMap(thread_it, objects, &object_map))
-        return false;
-
-      // Increment the thread event iterator and reinsert it in the heap if
-      // there are remaining events.
-      if (thread_it.increment()) {
-        heap.push_back(thread_it);
-        std::push_heap(heap.begin(), heap.end());
-      }
+    } else if (!GrindProcessData(kMaxTimestamp, &proc.second)) {
+      return false;
     }
   }
 
@@ -313,6 +299,15 @@ bool MemReplayGrinder::OutputData(FILE* file) {
   // Save a magic header and version so that readers can validate the stream.
   if (!out_archive.Save(bard::Story::kBardMagic))
     return false;
+  if (stream_window_ != 0) {
+    if (!out_archive.Save(bard::Story::kBardChunkedVersion))
+      return false;
+    if (!OutputStreamedChunks(&zout_stream, &out_archive))
+      return false;
+    if (!zout_stream.Flush())
+      return false;
+    return out_stream.Flush();
+  }
   if (!out_archive.Save(bard::Story::kBardVersion))
     return false;
 
@@ -438,8 +433,14 @@ void MemReplayGrinder::OnProcessHeap(base::Time time,
 
   ProcessData* proc_data = FindOrCreateProcessData(process_id);
   DCHECK_NE(static_cast<ProcessData*>(nullptr), proc_data);
-  proc_data->existing_heaps.push_back(
-      reinterpret_cast<const void*>(data->process_heap));
+  const void* heap = reinterpret_cast<const void*>(data->process_heap);
+  proc_data->existing_heaps.push_back(heap);
+
+  // Prepopulate the object map with an entry for the heap, as it exists
+  // before any event.
+  const ThreadDataIterator kDummyThreadDataIterator = {nullptr, 0};
+  proc_data->object_map.insert(
+      std::make_pair(heap, ObjectInfo(kDummyThreadDataIterator)));
 }
 
 void MemReplayGrinder::LoadAsanFunctionNames() {
@@ -467,6 +468,15 @@ bool MemReplayGrinder::ParseDetailedFunctionCall(
   if (!BuildArgumentConverters(data, &args))
     return false;
 
+  // When streaming, the events older than the window have already been
+  // ground, and this one can't be ordered among them anymore.
+  if (stream_window_ != 0 && data->timestamp < proc_data->stream_horizon) {
+    LOG(ERROR) << "Encountered an event older than the stream window, "
+               << "which must be made larger.";
+    LOG(ERROR) << "  Timestamp: " << std::hex << data->timestamp;
+    return false;
+  }
+
   // Get the associated thread data. This should not fail.
   ThreadData* thread_data = FindOrCreateThreadData(proc_data, thread_id);
   DCHECK_NE(static_cast<ThreadData*>(nullptr), thread_data);
@@ -556,6 +566,15 @@ bool MemReplayGrinder::ParseDetailedFunctionCall(
 
   thread_data->plot_line->push_back(evt.release());
   thread_data->timestamps.push_back(data->timestamp);
+  ++proc_data->pending_event_count;
+
+  // When streaming, regularly grind the events that have fallen out of the
+  // window.
+  if (stream_window_ != 0 &&
+      proc_data->pending_event_count >= 2 * stream_window_) {
+    return FlushProcessData(false, proc_data);
+  }
+
   return true;
 }
 
@@ -563,6 +582,188 @@ void MemReplayGrinder::SetParseError() {
   parse_error_ = true;
 }
 
+bool MemReplayGrinder::GrindProcessData(uint64_t horizon,
+                                        ProcessData* proc_data) {
+  DCHECK_NE(static_cast<ProcessData*>(nullptr), proc_data);
+
+  // Make a heap of the events to be ground across all threads in this
+  // process.
+  std::vector<ThreadDataIterator> heap;
+  for (auto& thread : proc_data->thread_data_map) {
+    ThreadData& thread_data = thread.second;
+    DCHECK_LE(thread_data.first_index, thread_data.next_index);
+    if (thread_data.next_index - thread_data.first_index >=
+        thread_data.timestamps.size()) {
+      continue;
+    }
+    ThreadDataIterator thread_it = {&thread_data, thread_data.next_index};
+    if (thread_it.timestamp() < horizon)
+      heap.push_back(thread_it);
+  }
+  std::make_heap(heap.begin(), heap.end());
+
+  // When streaming, dependencies are gathered for the next story chunk.
+  bard::Story::ChunkDeps* chunk_deps = nullptr;
+  if (stream_window_ != 0)
+    chunk_deps = &proc_data->chunk_deps;
+
+  // Process all of the thread events in the serial order in which they
+  // occurred. While doing so update the object map and waited map, and
+  // encode dependencies in the underlying PlotLine structures.
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end());
+    auto thread_it = heap.back();
+    heap.pop_back();
+
+    // Determine inputs and outputs of this event.
+    EventObjects objects;
+    GetEventObjects(thread_it, &objects);
+
+    // Determine input dependencies for this event.
+    Deps deps;
+    if (!GetDeps(thread_it, objects, proc_data->object_map, &deps))
+      return false;
+
+    // Encode dependencies as explicit synchronization points as required,
+    // and update the waited map with this information.
+    if (!ApplyDeps(thread_it, proc_data->object_map, deps,
+                   &proc_data->waited_map, chunk_deps)) {
+      return false;
+    }
+
+    // Update the object map to reflect objects that have been destroyed,
+    // created, or used.
+    if (!UpdateObjectMap(thread_it, objects, &proc_data->object_map))
+      return false;
+
+    DCHECK_LT(0u, proc_data->pending_event_count);
+    --proc_data->pending_event_count;
+    thread_it.thread_data->next_index = thread_it.index + 1;
+
+    // Increment the thread event iterator and reinsert it in the heap if
+    // there are remaining events to be ground.
+    if (thread_it.increment() && thread_it.timestamp() < horizon) {
+      heap.push_back(thread_it);
+      std::push_heap(heap.begin(), heap.end());
+    }
+  }
+
+  return true;
+}
+
+bool MemReplayGrinder::FlushProcessData(bool final, ProcessData* proc_data) {
+  DCHECK_NE(0u, stream_window_);
+  DCHECK_NE(static_cast<ProcessData*>(nullptr), proc_data);
+
+  // Grind the events that are older than the most recent ones in the window,
+  // or all of them if this is the final flush.
+  uint64_t horizon = kMaxTimestamp;
+  if (!final) {
+    std::vector<uint64_t> timestamps;
+    timestamps.reserve(proc_data->pending_event_count);
+    for (const auto& thread : proc_data->thread_data_map) {
+      const ThreadData& thread_data = thread.second;
+      timestamps.insert(timestamps.end(),
+                        thread_data.timestamps.begin() +
+                            (thread_data.next_index - thread_data.first_index),
+                        thread_data.timestamps.end());
+    }
+    if (timestamps.size() <= stream_window_)
+      return true;
+    auto window_start = timestamps.end() - stream_window_;
+    std::nth_element(timestamps.begin(), window_start, timestamps.end());
+    horizon = *window_start;
+  }
+  if (!GrindProcessData(horizon, proc_data))
+    return false;
+  proc_data->stream_horizon = std::max(proc_data->stream_horizon, horizon);
+
+  // Move the ground events out of the plot lines, and into the chunk.
+  bool empty_chunk = proc_data->chunk_deps.empty();
+  ScopedVector<bard::Story::PlotLine> chunk;
+  for (size_t i = 0; i < proc_data->story->plot_lines().size(); ++i)
+    chunk.push_back(new bard::Story::PlotLine());
+  for (auto& thread : proc_data->thread_data_map) {
+    ThreadData& thread_data = thread.second;
+    size_t ground_count = thread_data.next_index - thread_data.first_index;
+    if (ground_count == 0)
+      continue;
+    empty_chunk = false;
+
+    bard::Story::PlotLine* plot_line = thread_data.plot_line;
+    bard::Story::PlotLine* chunk_plot_line =
+        chunk[thread_data.plot_line_index];
+    for (size_t i = 0; i < ground_count; ++i)
+      chunk_plot_line->push_back((*plot_line)[i]);
+    plot_line->weak_erase(plot_line->begin(),
+                          plot_line->begin() + ground_count);
+    thread_data.timestamps.erase(
+        thread_data.timestamps.begin(),
+        thread_data.timestamps.begin() + ground_count);
+    thread_data.first_index = thread_data.next_index;
+  }
+  if (empty_chunk)
+    return true;
+
+  // Write out the chunk.
+  DCHECK_NE(static_cast<core::OutArchive*>(nullptr), stream_archive_.get());
+  if (!stream_archive_->Save(static_cast<uint32_t>(proc_data->process_id)) ||
+      !bard::Story::SaveChunk(chunk, proc_data->chunk_deps,
+                              stream_archive_.get())) {
+    LOG(ERROR) << "Failed to write a story chunk.";
+    return false;
+  }
+  proc_data->chunk_deps.clear();
+  ++stream_chunk_count_;
+
+  return true;
+}
+
+bool MemReplayGrinder::OutputStreamedChunks(core::OutStream* out_stream,
+                                            core::OutArchive* out_archive) {
+  DCHECK_NE(static_cast<core::OutStream*>(nullptr), out_stream);
+  DCHECK_NE(static_cast<core::OutArchive*>(nullptr), out_archive);
+  DCHECK_NE(static_cast<FILE*>(nullptr), stream_file_.get());
+
+  // Copy the chunks spilled to the stream file.
+  if (!out_archive->Save(stream_chunk_count_))
+    return false;
+  if (!stream_archive_->Flush() || !stream_out_stream_->Flush())
+    return false;
+  if (::fseek(stream_file_.get(), 0, SEEK_SET) != 0)
+    return false;
+  std::vector<uint8_t> buffer(kStreamCopyBufferSize);
+  while (true) {
+    size_t bytes_read =
+        ::fread(buffer.data(), 1, buffer.size(), stream_file_.get());
+    if (bytes_read == 0)
+      break;
+    if (!out_stream->Write(bytes_read, buffer.data()))
+      return false;
+  }
+  if (::ferror(stream_file_.get()))
+    return false;
+
+  // Output the existing heaps of each process. The first of these is the
+  // process heap.
+  if (!out_archive->Save(static_cast<size_t>(process_data_map_.size())))
+    return false;
+  for (const auto& proc_data_pair : process_data_map_) {
+    const ProcessData& proc_data = proc_data_pair.second;
+    if (!out_archive->Save(static_cast<uint32_t>(proc_data.process_id)))
+      return false;
+    size_t heap_count = proc_data.existing_heaps.size();
+    if (!out_archive->Save(heap_count))
+      return false;
+    for (const auto& heap : proc_data.existing_heaps) {
+      if (!out_archive->Save(reinterpret_cast<uintptr_t>(heap)))
+        return false;
+    }
+  }
+
+  return true;
+}
+
 MemReplayGrinder::PendingDetailedFunctionCall::PendingDetailedFunctionCall(
     base::Time time,
     DWORD thread_id,
@@ -598,9 +799,9 @@ MemReplayGrinder::ThreadData* MemReplayGrinder::FindOrCreateThreadData(
   if (it != proc_data->thread_data_map.end() && it->first == thread_id)
     return &it->second;
 
-  bard::Story::PlotLine* plot_line = proc_data->story->CreatePlotLine();
   ThreadData thread_data;
-  thread_data.plot_line = plot_line;
+  thread_data.plot_line_index = proc_data->story->plot_lines().size();
+  thread_data.plot_line = proc_data->story->CreatePlotLine();
   it = proc_data->thread_data_map.insert(
       it, std::make_pair(thread_id, thread_data));
   return &it->second;
@@ -761,7 +962,7 @@ void MemReplayGrinder::AddDep(const ThreadDataIterator& iter,
     return;
 
   // Dependencies can only be to older events.
-  DCHECK_LT(input.timestamp(), iter.timestamp());
+  DCHECK(input.released() || input.timestamp() < iter.timestamp());
 
   // Dependencies to events on the same thread are implicit and need not be
   // encoded.
@@ -774,7 +975,8 @@ void MemReplayGrinder::AddDep(const ThreadDataIterator& iter,
 bool MemReplayGrinder::ApplyDeps(const ThreadDataIterator& iter,
                                  const ObjectMap& object_map,
                                  const Deps& deps,
-                                 WaitedMap* waited_map) {
+                                 WaitedMap* waited_map,
+                                 bard::Story::ChunkDeps* chunk_deps) {
   DCHECK_NE(static_cast<WaitedMap*>(nullptr), waited_map);
 
   for (auto dep : deps) {
@@ -800,6 +1002,15 @@ bool MemReplayGrinder::ApplyDeps(const ThreadDataIterator& iter,
       waited_map->insert(waited_it, std::make_pair(plot_line_pair, dep));
     }
 
+    // When streaming, the dependency may already have been written out, so
+    // it is recorded by position for the story chunk instead.
+    if (chunk_deps != nullptr) {
+      chunk_deps->push_back(bard::Story::ChunkDep(
+          bard::Story::EventId(iter.thread_data->plot_line_index, iter.index),
+          bard::Story::EventId(dep.thread_data->plot_line_index, dep.index)));
+      continue;
+    }
+
     // Make ourselves and the dependency linked events if necessary.
     EnsureLinkedEvent(iter);
     EnsureLinkedEvent(dep);
@@ -15,6 +15,26 @@
 // Declares the MemReplayGrinder class, which processes trace files
 // containing the list of heap accesses and outputs a test scenario
 // for replay.
+//
+// By default the whole story of each process is built in memory, and saved
+// with bard::Story::Save once all the trace files have been parsed. When
+// streaming over a window of events, the stories are instead ground as the
+// events are parsed, and saved as a sequence of chunks with
+// bard::Story::SaveChunk. The output is then organized as follows:
+//
+// - bard::Story::kBardMagic
+// - bard::Story::kBardChunkedVersion
+// - number of chunks
+// - Chunk0
+//   - ID of the process the chunk belongs to
+//   - serialization of the story chunk
+// - ... repeated for other chunks ...
+// - number of processes
+// - Process0
+//   - ID of the process
+//   - number of pre-existing heaps, the first being the process heap
+//   - the pre-existing heaps
+// - ... repeated for other processes ...
 #ifndef SYZYGY_GRINDER_GRINDERS_MEM_REPLAY_GRINDER_H_
 #define SYZYGY_GRINDER_GRINDERS_MEM_REPLAY_GRINDER_H_
 
@@ -28,9 +48,12 @@
 #include <utility>
 #include <vector>
 
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
 #include "syzygy/bard/event.h"
 #include "syzygy/bard/story.h"
 #include "syzygy/bard/events/linked_event.h"
+#include "syzygy/core/serialization.h"
 #include "syzygy/grinder/grinder.h"
 
 namespace grinder {
@@ -105,6 +128,26 @@ class MemReplayGrinder : public GrinderInterface {
                                  ProcessData* proc_data);
   // Sets parse_error_ to true.
   void SetParseError();
+  // Grinds the events of a process in the serial order in which they
+  // occurred, up to a given timestamp.
+  // @param horizon the timestamp of the first event not to be ground.
+  // @param proc_data the process whose events are to be ground.
+  // @returns true on success, false otherwise.
+  bool GrindProcessData(uint64_t horizon, ProcessData* proc_data);
+  // When streaming, grinds the events of a process that are outside of the
+  // stream window, and writes them out as a story chunk.
+  // @param final if true, all the events are ground regardless of the
+  //     window.
+  // @param proc_data the process whose events are to be flushed.
+  // @returns true on success, false otherwise.
+  bool FlushProcessData(bool final, ProcessData* proc_data);
+  // Outputs the story chunks that were streamed, followed by the existing
+  // heaps of each process.
+  // @param out_stream the stream to copy the chunks to.
+  // @param out_archive the archive writing to @p out_stream.
+  // @returns true on success, false otherwise.
+  bool OutputStreamedChunks(core::OutStream* out_stream,
+                            core::OutArchive* out_archive);
   // Finds or creates the process data for a given process.
   // @param process_id The ID of the process.
   // @returns the associated ProcessData.
@@ -151,10 +194,13 @@ class MemReplayGrinder : public GrinderInterface {
   // @param object_map The map describing the state of all known objects.
   // @param deps The list of input dependencies.
   // @param waited_map The map of already expressed dependencies to be updated.
+  // @param chunk_deps If not null, the dependencies are appended to this
+  //     list rather than being encoded as linked events.
   bool ApplyDeps(const ThreadDataIterator& iter,
                  const ObjectMap& object_map,
                  const Deps& deps,
-                 WaitedMap* waited_map);
+                 WaitedMap* waited_map,
+                 bard::Story::ChunkDeps* chunk_deps);
   // Updates the provided @p live_object_map and @p dead_object_map with
   // information from the event pointed to by @p iter.
   // @param iter The iterator pointing to the event being processed.
@@ -183,6 +229,20 @@ class MemReplayGrinder : public GrinderInterface {
   // Set to true if a parse error occurs.
   bool parse_error_;
 
+  // The number of most recent events of each process that are kept in
+  // memory when streaming, or zero if not streaming. Events are assumed to
+  // arrive no later than this many events after those that follow them.
+  size_t stream_window_;
+  // When streaming, the story chunks are spilled to a temporary file until
+  // they are output. The file is declared after its directory, so that it
+  // is closed before the directory is deleted.
+  base::ScopedTempDir stream_dir_;
+  base::ScopedFILE stream_file_;
+  std::unique_ptr<core::FileOutStream> stream_out_stream_;
+  std::unique_ptr<core::NativeBinaryOutArchive> stream_archive_;
+  // The number of story chunks written to the stream.
+  size_t stream_chunk_count_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(MemReplayGrinder);
 };
@@ -213,48 +273,43 @@ class MemReplayGrinder::PendingDetailedFunctionCall {
 // Houses timestamps and PlotLine data associated with a thread ID. This is
 // indexed by thread ID in a containing ProcessData.
 struct MemReplayGrinder::ThreadData {
-  ThreadData() : plot_line(nullptr) {}
+  ThreadData()
+      : plot_line(nullptr),
+        plot_line_index(0),
+        first_index(0),
+        next_index(0) {}
 
   // The timestamps associated with the events in the plot line.
   std::vector<uint64_t> timestamps;
   // The PlotLine representing the events in this thread.
   bard::Story::PlotLine* plot_line;
-};
-
-// Houses all data associated with a single process during grinding. This is
-// indexed in a map by |process_id|.
-struct MemReplayGrinder::ProcessData {
-  ProcessData() : process_id(0), story(nullptr) {}
-
-  // The process ID.
-  DWORD process_id;
-  // All pre-existing heaps. The first is the process heap.
-  std::vector<const void*> existing_heaps;
-  // Map from trace file function ID to EventType enumeration.
-  std::map<uint32_t, EventType> function_id_map;
-  // The set of function IDs for which definitions have not yet been seen.
-  // When this set is drained all the pending_calls can be processed.
-  std::unordered_set<uint32_t> pending_function_ids;
-  // The list of detailed function calls that is pending processing.
-  PendingDetailedFunctionCalls pending_calls;
-  // The story holding events for this process. Ownership is external
-  // to this object.
-  bard::Story* story;
-  // A map of thread ID to the associated thread data.
-  std::map<DWORD, ThreadData> thread_data_map;
+  // The index of the plot line in the story.
+  size_t plot_line_index;
+  // The index in the thread of the first event of the plot line. This is
+  // non-zero once events have been streamed out and released.
+  size_t first_index;
+  // The index in the thread of the next event to be ground.
+  size_t next_index;
 };
 
 // An iterator-like object for events in a story, sorted by their associated
 // timestamp.
 struct MemReplayGrinder::ThreadDataIterator {
-  uint64_t timestamp() const { return thread_data->timestamps[index]; }
+  uint64_t timestamp() const {
+    DCHECK(!released());
+    return thread_data->timestamps[index - thread_data->first_index];
+  }
 
   bard::Story::PlotLine* plot_line() const { return thread_data->plot_line; }
 
   bard::EventInterface* event() const {
-    return (*thread_data->plot_line)[index];
+    DCHECK(!released());
+    return (*thread_data->plot_line)[index - thread_data->first_index];
   }
 
+  // Returns true if the event has been streamed out and released.
+  bool released() const { return index < thread_data->first_index; }
+
   const bard::EventInterface* inner_event() const {
     auto evt = event();
     if (evt->type() != EventInterface::kLinkedEvent)
@@ -273,7 +328,7 @@ struct MemReplayGrinder::ThreadDataIterator {
   // in the associated plot line.
   bool increment() {
     ++index;
-    return index < thread_data->timestamps.size();
+    return index - thread_data->first_index < thread_data->timestamps.size();
   }
 
   // Comparison operator required for use in unordered_set.
@@ -328,6 +383,48 @@ class MemReplayGrinder::ObjectInfo {
   // with STL containers.
 };
 
+// Houses all data associated with a single process during grinding. This is
+// indexed in a map by |process_id|.
+struct MemReplayGrinder::ProcessData {
+  ProcessData()
+      : process_id(0),
+        story(nullptr),
+        pending_event_count(0),
+        stream_horizon(0) {}
+
+  // The process ID.
+  DWORD process_id;
+  // All pre-existing heaps. The first is the process heap.
+  std::vector<const void*> existing_heaps;
+  // Map from trace file function ID to EventType enumeration.
+  std::map<uint32_t, EventType> function_id_map;
+  // The set of function IDs for which definitions have not yet been seen.
+  // When this set is drained all the pending_calls can be processed.
+  std::unordered_set<uint32_t> pending_function_ids;
+  // The list of detailed function calls that is pending processing.
+  PendingDetailedFunctionCalls pending_calls;
+  // The story holding events for this process. Ownership is external
+  // to this object.
+  bard::Story* story;
+  // A map of thread ID to the associated thread data.
+  std::map<DWORD, ThreadData> thread_data_map;
+  // The state of all known objects, kept across calls to GrindProcessData.
+  // When streaming, this holds the live objects and the last occupant of the
+  // addresses of the dead ones, which bounds it by the address space used by
+  // the process rather than by the length of the trace.
+  ObjectMap object_map;
+  // The dependencies already encoded between the threads.
+  WaitedMap waited_map;
+  // The number of events that have been parsed but not ground yet.
+  size_t pending_event_count;
+  // When streaming, the timestamp of the first event not ground yet. Events
+  // older than this arrived too late to be ground in order.
+  uint64_t stream_horizon;
+  // When streaming, the dependencies of the events ground since the last
+  // story chunk was written.
+  bard::Story::ChunkDeps chunk_deps;
+};
+
 // Houses inputs and outputs of an input, by type.
 struct MemReplayGrinder::EventObjects {
   void* created;
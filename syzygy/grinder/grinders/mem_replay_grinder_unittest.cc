@@ -22,6 +22,7 @@
 #include "syzygy/bard/events/heap_alloc_event.h"
 #include "syzygy/bard/events/linked_event.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/core/zstream.h"
 #include "syzygy/pe/unittest_util.h"
 
 namespace grinder {
@@ -41,6 +42,7 @@ class TestMemReplayGrinder : public MemReplayGrinder {
   using MemReplayGrinder::missing_events_;
   using MemReplayGrinder::parse_error_;
   using MemReplayGrinder::process_data_map_;
+  using MemReplayGrinder::stream_chunk_count_;
 
   // Member functions.
   using MemReplayGrinder::FindOrCreateProcessData;
@@ -62,6 +64,13 @@ class TestMemReplayGrinder : public MemReplayGrinder {
     OnFunctionNameTableEntry(base::Time::Now(), process_id, data);
   }
 
+  // Creates and dispatches a TraceProcessHeap event.
+  void PlayProcessHeap(uint32_t process_id, HANDLE heap) {
+    TraceProcessHeap data = {};
+    data.process_heap = reinterpret_cast<uint32_t>(heap);
+    OnProcessHeap(base::Time::Now(), process_id, &data);
+  }
+
   // Creates and dispatches a heap alloc function call.
   void PlayHeapAllocCall(uint32_t process_id,
                          uint32_t thread_id,
@@ -331,5 +340,106 @@ TEST_F(MemReplayGrinderTest, GrindHarnessTrace) {
   output_file.reset();
 }
 
+TEST_F(MemReplayGrinderTest, StreamWindow) {
+  TestMemReplayGrinder grinder;
+  cmd_line_.AppendSwitchASCII("stream-window", "1");
+  ASSERT_TRUE(grinder.ParseCommandLine(&cmd_line_));
+
+  const HANDLE kHandle = reinterpret_cast<HANDLE>(0xDEADBEEF);
+  const DWORD kFlags = 0xFF;
+  const SIZE_T kBytes = 247;
+  const uintptr_t kRet = 0xBAADF00D;
+
+  // Allocate from the process heap on two threads, in turns.
+  grinder.PlayProcessHeap(1, kHandle);
+  grinder.PlayFunctionNameTableEntry(1, 1, kHeapAlloc);
+  for (uint32_t i = 0; i < 6; ++i) {
+    grinder.PlayHeapAllocCall(1, 1 + i % 2, i + 1, 1, 0, kHandle, kFlags,
+                              kBytes, reinterpret_cast<LPVOID>(kRet + i));
+  }
+  EXPECT_FALSE(grinder.parse_error_);
+
+  // Only the most recent events are kept in memory.
+  auto proc_data = grinder.FindOrCreateProcessData(1);
+  size_t event_count = 0;
+  for (const auto& thread : proc_data->thread_data_map)
+    event_count += thread.second.plot_line->size();
+  EXPECT_GE(2u, event_count);
+  EXPECT_LT(0u, grinder.stream_chunk_count_);
+
+  // An event older than the window can't be ground anymore.
+  TestMemReplayGrinder late_grinder;
+  ASSERT_TRUE(late_grinder.ParseCommandLine(&cmd_line_));
+  late_grinder.PlayProcessHeap(1, kHandle);
+  late_grinder.PlayFunctionNameTableEntry(1, 1, kHeapAlloc);
+  for (uint32_t i = 0; i < 4; ++i) {
+    late_grinder.PlayHeapAllocCall(1, 1, i + 10, 1, 0, kHandle, kFlags, kBytes,
+                                   reinterpret_cast<LPVOID>(kRet + i));
+  }
+  EXPECT_FALSE(late_grinder.parse_error_);
+  late_grinder.PlayHeapAllocCall(1, 2, 1, 1, 0, kHandle, kFlags, kBytes,
+                                 reinterpret_cast<LPVOID>(kRet + 4));
+  EXPECT_TRUE(late_grinder.parse_error_);
+
+  // Output the chunks, and read them back.
+  EXPECT_TRUE(grinder.Grind());
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath output_path = temp_dir.path().AppendASCII("output.bin");
+  base::ScopedFILE output_file(base::OpenFile(output_path, "wb"));
+  EXPECT_TRUE(grinder.OutputData(output_file.get()));
+  output_file.reset();
+  output_file.reset(base::OpenFile(output_path, "rb"));
+  ASSERT_TRUE(output_file.get());
+
+  core::FileInStream in_stream(output_file.get());
+  core::ZInStream zin_stream(&in_stream);
+  core::NativeBinaryInArchive in_archive(&zin_stream);
+  ASSERT_TRUE(zin_stream.Init());
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  size_t chunk_count = 0;
+  ASSERT_TRUE(in_archive.Load(&magic));
+  ASSERT_TRUE(in_archive.Load(&version));
+  ASSERT_TRUE(in_archive.Load(&chunk_count));
+  EXPECT_EQ(bard::Story::kBardMagic, magic);
+  EXPECT_EQ(bard::Story::kBardChunkedVersion, version);
+  EXPECT_EQ(grinder.stream_chunk_count_, chunk_count);
+
+  bard::Story story;
+  for (size_t i = 0; i < chunk_count; ++i) {
+    uint32_t process_id = 0;
+    ASSERT_TRUE(in_archive.Load(&process_id));
+    EXPECT_EQ(1u, process_id);
+    ASSERT_TRUE(story.LoadChunk(&in_archive));
+  }
+
+  size_t process_count = 0;
+  uint32_t process_id = 0;
+  size_t heap_count = 0;
+  uintptr_t heap = 0;
+  ASSERT_TRUE(in_archive.Load(&process_count));
+  ASSERT_TRUE(in_archive.Load(&process_id));
+  ASSERT_TRUE(in_archive.Load(&heap_count));
+  ASSERT_TRUE(in_archive.Load(&heap));
+  EXPECT_EQ(1u, process_count);
+  EXPECT_EQ(1u, process_id);
+  EXPECT_EQ(1u, heap_count);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(kHandle), heap);
+
+  // Each thread made three allocations, in order.
+  ASSERT_EQ(2u, story.plot_lines().size());
+  for (size_t i = 0; i < story.plot_lines().size(); ++i) {
+    const bard::Story::PlotLine& plot_line = *story.plot_lines()[i];
+    ASSERT_EQ(3u, plot_line.size());
+    for (size_t j = 0; j < plot_line.size(); ++j) {
+      ASSERT_EQ(bard::EventInterface::kHeapAllocEvent, plot_line[j]->type());
+      auto ha =
+          reinterpret_cast<const bard::events::HeapAllocEvent*>(plot_line[j]);
+      EXPECT_EQ(reinterpret_cast<LPVOID>(kRet + i + 2 * j), ha->trace_alloc());
+    }
+  }
+}
+
 }  // namespace grinders
 }  // namespace grinder
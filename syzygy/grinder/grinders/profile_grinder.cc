@@ -14,21 +14,20 @@
 
 #include "syzygy/grinder/grinders/profile_grinder.h"
 
+#include <algorithm>
+#include <utility>
+
 #include "base/at_exit.h"
 #include "base/command_line.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
-#include "base/win/scoped_bstr.h"
-#include "syzygy/common/com_utils.h"
-#include "syzygy/pe/dia_util.h"
+#include "base/sys_info.h"
 #include "syzygy/pe/find.h"
 
 namespace grinder {
 namespace grinders {
 
-using base::win::ScopedBstr;
-using base::win::ScopedComPtr;
 using trace::parser::AbsoluteAddress64;
 using trace::parser::ParseEventHandler;
 using pe::ModuleInformation;
@@ -152,6 +151,29 @@ void ProfileGrinder::SetParser(Parser* parser) {
   parser_ = parser;
 }
 
+std::unique_ptr<GrinderInterface> ProfileGrinder::CreateWorker() {
+  std::unique_ptr<ProfileGrinder> worker(new ProfileGrinder());
+  worker->thread_parts_ = thread_parts_;
+  return std::move(worker);
+}
+
+bool ProfileGrinder::MergeWorker(GrinderInterface* worker) {
+  DCHECK(worker != NULL);
+  const ProfileGrinder* profile_worker = static_cast<ProfileGrinder*>(worker);
+  DCHECK_EQ(thread_parts_, profile_worker->thread_parts_);
+
+  DynamicSymbolMap::const_iterator symbol_it =
+      profile_worker->dynamic_symbols_.begin();
+  for (; symbol_it != profile_worker->dynamic_symbols_.end(); ++symbol_it)
+    dynamic_symbols_[symbol_it->first] = symbol_it->second;
+
+  PartDataMap::const_iterator part_it = profile_worker->parts_.begin();
+  for (; part_it != profile_worker->parts_.end(); ++part_it)
+    MergePart(part_it->second);
+
+  return true;
+}
+
 bool ProfileGrinder::Grind() {
   if (!ResolveCallers()) {
     LOG(ERROR) << "Error resolving callers.";
@@ -160,84 +182,43 @@ bool ProfileGrinder::Grind() {
   return true;
 }
 
-bool ProfileGrinder::GetSessionForModule(const ModuleInformation* module,
-                                         IDiaSession** session_out) {
+const FunctionTable* ProfileGrinder::GetFunctionTableForModule(
+    const ModuleInformation* module) {
   DCHECK(module != NULL);
-  DCHECK(session_out != NULL);
-  DCHECK(*session_out == NULL);
-
-  ModuleSessionMap::const_iterator it(
-      module_sessions_.find(module));
 
-  if (it == module_sessions_.end()) {
-    ScopedComPtr<IDiaDataSource> source;
-    if (!pe::CreateDiaSource(source.Receive()))
-      return false;
+  ModuleFunctionTableMap::const_iterator it(function_tables_.find(module));
+  if (it == function_tables_.end()) {
+    std::unique_ptr<FunctionTable> table(new FunctionTable());
 
     base::FilePath module_path;
+    base::FilePath pdb_path;
     if (!pe::FindModuleBySignature(*module, &module_path) ||
         module_path.empty()) {
       LOG(ERROR) << "Unable to find module matching signature.";
-      return false;
+      table.reset();
+    } else if (!pe::FindPdbForModule(module_path, &pdb_path) ||
+               pdb_path.empty()) {
+      LOG(ERROR) << "Unable to find PDB for module \""
+                 << module_path.value() << "\".";
+      table.reset();
+    } else if (!table->Init(pdb_path)) {
+      LOG(WARNING) << "Failed to read the functions of PDB \""
+                   << pdb_path.value() << "\".";
+      table.reset();
     }
 
-    ScopedComPtr<IDiaSession> new_session;
-    // We first try loading straight-up for the module. If the module is at
-    // this path and the symsrv machinery is available, this will bring that
-    // machinery to bear.
-    // The downside is that if the module at this path does not match the
-    // original module, we may load the wrong symbol information for the
-    // module.
-    HRESULT hr = source->loadDataForExe(module_path.value().c_str(),
-                                        NULL, NULL);
-    if (SUCCEEDED(hr)) {
-        hr = source->openSession(new_session.Receive());
-        if (FAILED(hr))
-          LOG(ERROR) << "Failure in openSession: " << common::LogHr(hr) << ".";
-    } else {
-      DCHECK(FAILED(hr));
-
-      base::FilePath pdb_path;
-      if (!pe::FindPdbForModule(module_path, &pdb_path) ||
-          pdb_path.empty()) {
-        LOG(ERROR) << "Unable to find PDB for module \""
-                   << module_path.value() << "\".";
-      }
-
-      hr = source->loadDataFromPdb(pdb_path.value().c_str());
-      if (SUCCEEDED(hr)) {
-        hr = source->openSession(new_session.Receive());
-        if (FAILED(hr))
-          LOG(ERROR) << "Failure in openSession: " << common::LogHr(hr) << ".";
-      } else {
-        LOG(WARNING) << "Failure in loadDataFromPdb('"
-                     << module_path.value().c_str() << "'): "
-                     << common::LogHr(hr) << ".";
-      }
-    }
-
-    DCHECK((SUCCEEDED(hr) && new_session.get() != NULL) ||
-           (FAILED(hr) && new_session.get() == NULL));
-
     // We store an entry to the cache irrespective of whether we succeeded
-    // in opening a session above. This allows us to cache the failures, which
-    // means we attempt to load each module only once, and consequently log
-    // each failing module only once.
-    it = module_sessions_.insert(
-        std::make_pair(module, new_session)).first;
-  }
-  DCHECK(it != module_sessions_.end());
-
-  if (it->second.get() == NULL) {
-    // A negative session cache entry - we were previously unable to
-    // load this module.
-    return false;
+    // in reading the function table above. This allows us to cache the
+    // failures, which means we attempt to load each module only once, and
+    // consequently log each failing module only once.
+    it = function_tables_.insert(
+        std::make_pair(module, std::move(table))).first;
   }
+  DCHECK(it != function_tables_.end());
 
-  *session_out = it->second.get();
-  (*session_out)->AddRef();
-
-  return true;
+  // A NULL table is a negative cache entry - we were previously unable to
+  // load this module.
+  return it->second.get();
 }
 
 ProfileGrinder::PartData* ProfileGrinder::FindOrCreatePart(DWORD process_id,
@@ -261,34 +242,6 @@ ProfileGrinder::PartData* ProfileGrinder::FindOrCreatePart(DWORD process_id,
   return &it->second;
 }
 
-bool ProfileGrinder::GetFunctionSymbolByRVA(IDiaSession* session,
-                                            RVA address,
-                                            IDiaSymbol** symbol) {
-  DCHECK(session != NULL);
-  DCHECK(symbol != NULL && *symbol == NULL);
-
-  ScopedComPtr<IDiaSymbol> function;
-  HRESULT hr = session->findSymbolByRVA(address,
-                                        SymTagFunction,
-                                        function.Receive());
-  if (FAILED(hr) || function.get() == NULL) {
-    // No private function, let's try for a public symbol.
-    hr = session->findSymbolByRVA(address,
-                                  SymTagPublicSymbol,
-                                  function.Receive());
-    if (FAILED(hr))
-      return false;
-  }
-  if (function.get() == NULL) {
-    LOG(ERROR) << "NULL function returned from findSymbolByRVA.";
-    return false;
-  }
-
-  *symbol = function.Detach();
-
-  return true;
-}
-
 bool ProfileGrinder::GetFunctionForCaller(const CallerLocation& caller,
                                           FunctionLocation* function,
                                           size_t* line) {
@@ -313,70 +266,78 @@ bool ProfileGrinder::GetFunctionForCaller(const CallerLocation& caller,
     return true;
   }
 
-  ScopedComPtr<IDiaSession> session;
-  if (!GetSessionForModule(caller.module(), session.Receive()))
+  const FunctionTable* table = GetFunctionTableForModule(caller.module());
+  if (table == NULL)
     return false;
 
-  ScopedComPtr<IDiaSymbol> function_sym;
-  if (!GetFunctionSymbolByRVA(session.get(),
-                              caller.rva(),
-                              function_sym.Receive())) {
+  core::RelativeAddress caller_rva(caller.rva());
+  const FunctionTable::Function* caller_function =
+      table->FindFunction(caller_rva);
+  if (caller_function == NULL) {
     LOG(ERROR) << "No symbol info available for function in module '"
                << caller.module()->path << "'";
-  }
-
-  // Get the RVA of the function.
-  DWORD rva = 0;
-  HRESULT hr = function_sym->get_relativeVirtualAddress(&rva);
-  if (FAILED(hr)) {
-    LOG(ERROR) << "Failure in get_relativeVirtualAddress: "
-               << common::LogHr(hr) << ".";
     return false;
   }
 
   // Return the module/rva we found.
-  function->Set(caller.module(), rva);
+  function->Set(caller.module(), caller_function->rva.value());
+  *line = GetLineNumber(*table, caller_rva);
+  return true;
+}
 
-  ULONGLONG length = 0;
-  hr = function_sym->get_length(&length);
-  if (FAILED(hr)) {
-    LOG(ERROR) << "Failure in get_length: " << common::LogHr(hr) << ".";
-    return false;
-  }
+bool ProfileGrinder::GetFunctionsForModuleCallers(
+    const ModuleInformation* module,
+    const std::vector<InvocationEdge*>& edges,
+    std::vector<FunctionLocation>* functions,
+    std::vector<bool>* resolved) {
+  DCHECK(module != NULL);
+  DCHECK(functions != NULL);
+  DCHECK(resolved != NULL);
 
-  DWORD line_number = 0;
-  if (length != 0) {
-    ScopedComPtr<IDiaEnumLineNumbers> enum_lines;
+  functions->resize(edges.size());
+  resolved->assign(edges.size(), false);
 
-    hr = session->findLinesByRVA(caller.rva(), length, enum_lines.Receive());
-    if (FAILED(hr)) {
-      LOG(ERROR) << "Failure in findLinesByRVA: " << common::LogHr(hr) << ".";
-      return false;
-    }
+  const FunctionTable* table = GetFunctionTableForModule(module);
+  if (table == NULL)
+    return false;
 
-    ScopedComPtr<IDiaLineNumber> line;
-    ULONG fetched = 0;
-    hr = enum_lines->Next(1, line.Receive(), &fetched);
-    if (FAILED(hr)) {
-      LOG(ERROR) << "Failure in IDiaLineNumber::Next: "
-                 << common::LogHr(hr) << ".";
-      return false;
+  // Sweep all of the callers against the function table at once.
+  std::vector<core::RelativeAddress> caller_rvas;
+  caller_rvas.reserve(edges.size());
+  for (size_t i = 0; i < edges.size(); ++i) {
+    DCHECK_EQ(module, edges[i]->caller.module());
+    caller_rvas.push_back(core::RelativeAddress(edges[i]->caller.rva()));
+  }
+  std::vector<const FunctionTable::Function*> caller_functions;
+  table->FindFunctions(caller_rvas, &caller_functions);
+  DCHECK_EQ(edges.size(), caller_functions.size());
+
+  bool success = true;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    if (caller_functions[i] == NULL) {
+      success = false;
+      continue;
     }
 
-    if (fetched == 1) {
-      hr = line->get_lineNumber(&line_number);
-      if (FAILED(hr)) {
-        LOG(ERROR) << "Failure in get_lineNumber: " << common::LogHr(hr) << ".";
-        return false;
-      }
-    } else if (fetched != 0) {
-      NOTREACHED() << "IDiaLineNumber::Next unexpectedly returned "
-                   << fetched << " elements.";
-    }
+    (*functions)[i].Set(module, caller_functions[i]->rva.value());
+    edges[i]->line = GetLineNumber(*table, caller_rvas[i]);
+    (*resolved)[i] = true;
+  }
+  if (!success) {
+    LOG(ERROR) << "No symbol info available for some functions in module '"
+               << module->path << "'";
   }
 
-  *line = line_number;
-  return true;
+  return success;
+}
+
+// static
+size_t ProfileGrinder::GetLineNumber(const FunctionTable& table,
+                                     core::RelativeAddress rva) {
+  const FunctionTable::Line* line = table.FindLine(rva);
+  if (line == NULL)
+    return 0;
+  return line->line_number;
 }
 
 bool ProfileGrinder::GetInfoForFunction(const FunctionLocation& function,
@@ -416,82 +377,48 @@ bool ProfileGrinder::GetInfoForFunction(const FunctionLocation& function,
     return true;
   }
 
-  ScopedComPtr<IDiaSession> session;
-  if (!GetSessionForModule(function.module(), session.Receive()))
+  const FunctionTable* table = GetFunctionTableForModule(function.module());
+  if (table == NULL)
     return false;
 
-  ScopedComPtr<IDiaSymbol> function_sym;
-  if (!GetFunctionSymbolByRVA(session.get(),
-                              function.rva(),
-                              function_sym.Receive())) {
+  core::RelativeAddress function_rva(function.rva());
+  const FunctionTable::Function* function_info =
+      table->FindFunction(function_rva);
+  if (function_info == NULL) {
     LOG(ERROR) << "No symbol info available for function in module '"
                << function.module()->path << "'";
     return false;
   }
 
-  ScopedBstr function_name_bstr;
-  HRESULT hr = function_sym->get_name(function_name_bstr.Receive());
-  if (FAILED(hr)) {
-    LOG(ERROR) << "Failure in get_name: " << common::LogHr(hr) << ".";
-    return false;
-  }
-
-  *function_name = common::ToString(function_name_bstr);
-
-  ULONGLONG length = 0;
-  hr = function_sym->get_length(&length);
-  if (FAILED(hr)) {
-    LOG(ERROR) << "Failure in get_length: " << common::LogHr(hr) << ".";
-    return false;
-  }
-
-  ScopedBstr file_name_bstr;
-  DWORD line_number = 0;
-  if (length != 0) {
-    ScopedComPtr<IDiaEnumLineNumbers> enum_lines;
-
-    hr = session->findLinesByRVA(function.rva(),
-                                 length,
-                                 enum_lines.Receive());
-    if (FAILED(hr)) {
-      LOG(ERROR) << "Failure in findLinesByRVA: " << common::LogHr(hr) << ".";
-      return false;
-    }
+  *function_name = base::UTF8ToWide(function_info->name);
 
-    ScopedComPtr<IDiaLineNumber> line;
-    ULONG fetched = 0;
-    hr = enum_lines->Next(1, line.Receive(), &fetched);
-    if (FAILED(hr)) {
-      LOG(ERROR) << "Failure in IDialineNumber::Next: "
-                 << common::LogHr(hr) << ".";
-      return false;
-    }
-    if (fetched == 1) {
-      hr = line->get_lineNumber(&line_number);
-      if (FAILED(hr)) {
-        LOG(ERROR) << "Failure in get_lineNumber: " << common::LogHr(hr) << ".";
-        return false;
-      }
-      ScopedComPtr<IDiaSourceFile> source_file;
-      hr = line->get_sourceFile(source_file.Receive());
-      if (FAILED(hr)) {
-        LOG(ERROR) << "Failure in get_sourceFile: " << common::LogHr(hr) << ".";
-        return false;
-      }
-      hr = source_file->get_fileName(file_name_bstr.Receive());
-      if (FAILED(hr)) {
-        LOG(ERROR) << "Failure in get_fileName: " << common::LogHr(hr) << ".";
-        return false;
-      }
-    }
+  // Public symbols have no line information.
+  const FunctionTable::Line* function_line = NULL;
+  if (function_info->length != 0)
+    function_line = table->FindLine(function_rva);
+  if (function_line != NULL) {
+    *file_name = base::UTF8ToWide(
+        table->source_files()[function_line->source_file]);
+    *line = function_line->line_number;
+  } else {
+    file_name->clear();
+    *line = 0;
   }
 
-  *file_name = common::ToString(file_name_bstr);
-  *line = line_number;
   return true;
 }
 
 bool ProfileGrinder::ResolveCallers() {
+  // Locate all of the modules up front, several at a time. The lookups made
+  // while resolving the callers are then answered by the find cache.
+  std::vector<ModuleInformation> modules(modules_.begin(), modules_.end());
+  std::vector<base::FilePath> module_paths;
+  size_t num_threads =
+      static_cast<size_t>(base::SysInfo::NumberOfProcessors());
+  if (!pe::FindModulesBySignature(modules, num_threads, &module_paths)) {
+    LOG(WARNING) << "Unable to locate all modules ahead of time.";
+  }
+
   PartDataMap::iterator it = parts_.begin();
   for (; it != parts_.end(); ++it) {
     if (!ResolveCallersForPart(&it->second))
@@ -502,14 +429,52 @@ bool ProfileGrinder::ResolveCallers() {
 }
 
 bool ProfileGrinder::ResolveCallersForPart(PartData* part) {
-  // We start by iterating all the edges, connecting them up to their caller,
-  // and subtracting the edge metric(s) to compute the inclusive metrics for
-  // each function.
+  // Resolve the functions of all the callers up front. The callers in
+  // modules are grouped by module, and resolved in a single sweep of its
+  // function table.
+  std::vector<InvocationEdge*> edges;
+  std::vector<FunctionLocation> functions(part->edges_.size());
+  std::vector<bool> resolved(part->edges_.size(), false);
+  std::map<const ModuleInformation*, std::vector<size_t>> module_edges;
   InvocationEdgeMap::iterator edge_it(part->edges_.begin());
   for (; edge_it != part->edges_.end(); ++edge_it) {
     InvocationEdge& edge = edge_it->second;
-    FunctionLocation function;
-    if (GetFunctionForCaller(edge.caller, &function, &edge.line)) {
+    size_t index = edges.size();
+    edges.push_back(&edge);
+    if (!edge.caller.is_symbol() && edge.caller.module() != NULL) {
+      module_edges[edge.caller.module()].push_back(index);
+      continue;
+    }
+    resolved[index] =
+        GetFunctionForCaller(edge.caller, &functions[index], &edge.line);
+  }
+
+  std::map<const ModuleInformation*, std::vector<size_t>>::const_iterator
+      module_it = module_edges.begin();
+  for (; module_it != module_edges.end(); ++module_it) {
+    const std::vector<size_t>& indices = module_it->second;
+    std::vector<InvocationEdge*> callers;
+    callers.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+      callers.push_back(edges[indices[i]]);
+
+    std::vector<FunctionLocation> caller_functions;
+    std::vector<bool> caller_resolved;
+    GetFunctionsForModuleCallers(module_it->first, callers,
+                                 &caller_functions, &caller_resolved);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      functions[indices[i]] = caller_functions[i];
+      resolved[indices[i]] = caller_resolved[i];
+    }
+  }
+
+  // We then iterate all the edges, connecting them up to their caller, and
+  // subtracting the edge metric(s) to compute the inclusive metrics for each
+  // function.
+  for (size_t i = 0; i < edges.size(); ++i) {
+    InvocationEdge& edge = *edges[i];
+    if (resolved[i]) {
+      const FunctionLocation& function = functions[i];
       InvocationNodeMap::iterator node_it(part->nodes_.find(function));
       if (node_it == part->nodes_.end()) {
         // This is a fringe node - e.g. this is a non-instrumented caller
@@ -736,6 +701,73 @@ void ProfileGrinder::AggregateEntryToPart(const FunctionLocation& function,
   }
 }
 
+void ProfileGrinder::CanonicalizeLocation(CodeLocation* location) {
+  DCHECK(location != NULL);
+
+  if (location->is_symbol() || location->module() == NULL)
+    return;
+
+  ModuleInformationSet::iterator it(modules_.find(*location->module()));
+  if (it == modules_.end())
+    it = modules_.insert(*location->module()).first;
+  DCHECK(it != modules_.end());
+
+  location->Set(&(*it), location->rva());
+}
+
+void ProfileGrinder::MergePart(const PartData& worker_part) {
+  PartData* part = FindOrCreatePart(worker_part.process_id_,
+                                    worker_part.thread_id_);
+  DCHECK(part != NULL);
+  if (!worker_part.thread_name_.empty())
+    part->thread_name_ = worker_part.thread_name_;
+
+  // The callers aren't resolved until Grind, so only the metrics of the
+  // nodes and edges need merging.
+  InvocationNodeMap::const_iterator node_it = worker_part.nodes_.begin();
+  for (; node_it != worker_part.nodes_.end(); ++node_it) {
+    FunctionLocation function = node_it->first;
+    CanonicalizeLocation(&function);
+
+    InvocationNodeMap::iterator found_it(part->nodes_.find(function));
+    if (found_it != part->nodes_.end()) {
+      AggregateMetrics(node_it->second.metrics, &found_it->second.metrics);
+    } else {
+      InvocationNode& node = part->nodes_[function];
+      node.function = function;
+      node.metrics = node_it->second.metrics;
+    }
+  }
+
+  InvocationEdgeMap::const_iterator edge_it = worker_part.edges_.begin();
+  for (; edge_it != worker_part.edges_.end(); ++edge_it) {
+    FunctionLocation function = edge_it->first.first;
+    CallerLocation caller = edge_it->first.second;
+    CanonicalizeLocation(&function);
+    CanonicalizeLocation(&caller);
+
+    InvocationEdgeKey key(function, caller);
+    InvocationEdgeMap::iterator found_it(part->edges_.find(key));
+    if (found_it != part->edges_.end()) {
+      AggregateMetrics(edge_it->second.metrics, &found_it->second.metrics);
+    } else {
+      InvocationEdge& edge = part->edges_[key];
+      edge.function = function;
+      edge.caller = caller;
+      edge.metrics = edge_it->second.metrics;
+    }
+  }
+}
+
+void ProfileGrinder::AggregateMetrics(const Metrics& metrics,
+                                      Metrics* aggregate) {
+  DCHECK(aggregate != NULL);
+  aggregate->num_calls += metrics.num_calls;
+  aggregate->cycles_min = std::min(aggregate->cycles_min, metrics.cycles_min);
+  aggregate->cycles_max = std::max(aggregate->cycles_max, metrics.cycles_max);
+  aggregate->cycles_sum += metrics.cycles_sum;
+}
+
 void ProfileGrinder::ConvertToModuleRVA(uint32_t process_id,
                                         AbsoluteAddress64 addr,
                                         CodeLocation* rva) {
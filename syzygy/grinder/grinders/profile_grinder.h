@@ -14,12 +14,13 @@
 #ifndef SYZYGY_GRINDER_GRINDERS_PROFILE_GRINDER_H_
 #define SYZYGY_GRINDER_GRINDERS_PROFILE_GRINDER_H_
 
-#include <dia2.h>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <vector>
 
 #include "base/files/file_path.h"
-#include "base/win/scoped_comptr.h"
+#include "syzygy/grinder/function_table.h"
 #include "syzygy/grinder/grinder.h"
 
 namespace grinder {
@@ -75,6 +76,8 @@ class ProfileGrinder : public GrinderInterface {
   // @{
   bool ParseCommandLine(const base::CommandLine* command_line) override;
   void SetParser(Parser* parser) override;
+  std::unique_ptr<GrinderInterface> CreateWorker() override;
+  bool MergeWorker(GrinderInterface* worker) override;
   bool Grind() override;
   bool OutputData(FILE* file) override;
   // @}
@@ -123,23 +126,18 @@ class ProfileGrinder : public GrinderInterface {
   typedef std::pair<FunctionLocation, CallerLocation> InvocationEdgeKey;
   typedef std::map<InvocationEdgeKey, InvocationEdge> InvocationEdgeMap;
 
-  typedef base::win::ScopedComPtr<IDiaSession> SessionPtr;
-  typedef std::map<const ModuleInformation*, SessionPtr> ModuleSessionMap;
+  typedef std::map<const ModuleInformation*, std::unique_ptr<FunctionTable>>
+      ModuleFunctionTableMap;
 
-  bool GetSessionForModule(const ModuleInformation* module,
-                           IDiaSession** session_out);
+  // Retrieves the function table of @p module, reading it from the module's
+  // PDB on first use.
+  // @returns the function table, or NULL if it couldn't be read.
+  const FunctionTable* GetFunctionTableForModule(
+      const ModuleInformation* module);
 
   // Finds or creates the part data for the given @p thread_id.
   PartData* FindOrCreatePart(DWORD process_id, DWORD thread_id);
 
-  // Retrieves the function containing @p address.
-  // @param symbol on success returns the function's private symbol, or
-  //     public symbol if no private symbol is available.
-  // @returns true on success.
-  bool GetFunctionSymbolByRVA(IDiaSession* session,
-                              RVA address,
-                              IDiaSymbol** symbol);
-
   // Resolves the function and line number a particular caller belongs to.
   // @param caller the location of the caller.
   // @param function on success returns the caller's function location.
@@ -148,11 +146,40 @@ class ProfileGrinder : public GrinderInterface {
                             FunctionLocation* function,
                             size_t* line);
 
+  // Resolves the functions and line numbers of a batch of callers in
+  // @p module, with a single sweep of its function table.
+  // @param module the module of the callers.
+  // @param edges the edges of the callers. On success, their line numbers
+  //     are updated.
+  // @param functions returns the function location of each caller.
+  // @param resolved returns whether each caller was resolved.
+  // @returns true if all the callers were resolved.
+  bool GetFunctionsForModuleCallers(const ModuleInformation* module,
+                                    const std::vector<InvocationEdge*>& edges,
+                                    std::vector<FunctionLocation>* functions,
+                                    std::vector<bool>* resolved);
+
+  // Retrieves the line number of @p rva in @p table, or zero if unknown.
+  static size_t GetLineNumber(const FunctionTable& table,
+                              core::RelativeAddress rva);
+
   bool GetInfoForFunction(const FunctionLocation& function,
                           std::wstring* function_name,
                           std::wstring* file_name,
                           size_t* line);
 
+  // Points a code location of a worker at the canonical module information
+  // of this grinder.
+  // @param location the code location to update.
+  void CanonicalizeLocation(CodeLocation* location);
+
+  // Merges a part of a worker into the matching part of this grinder.
+  // @param worker_part the part to merge.
+  void MergePart(const PartData& worker_part);
+
+  // Aggregates @p metrics into @p aggregate.
+  static void AggregateMetrics(const Metrics& metrics, Metrics* aggregate);
+
   // Converts an absolute address to an RVA.
   void ConvertToModuleRVA(uint32_t process_id,
                           trace::parser::AbsoluteAddress64 addr,
@@ -181,8 +208,8 @@ class ProfileGrinder : public GrinderInterface {
   // Stores the modules we encounter.
   ModuleInformationSet modules_;
 
-  // Stores the DIA session objects we have going for each module.
-  ModuleSessionMap module_sessions_;
+  // Stores the function tables we have read for each module.
+  ModuleFunctionTableMap function_tables_;
 
   // The parts we store. If thread_parts_ is false, we store only a single
   // part with id 0. The parts are keyed on process id/thread id.
@@ -206,6 +206,40 @@ TEST_F(ProfileGrinderTest, GrindSymbolTestData) {
   EXPECT_EQ(kCallerSymbolId, it->first.symbol_id());
 }
 
+TEST_F(ProfileGrinderTest, MergeWorkerSymbolTestData) {
+  TestProfileGrinder grinder;
+  EXPECT_TRUE(grinder.CreateWorker().get() != NULL);
+
+  // Issue the same events against two workers, and merge them.
+  for (size_t i = 0; i < 2; ++i) {
+    TestProfileGrinder worker;
+    IssueSetupEvents(&worker);
+    IssueSymbolInvocationEvent(&worker);
+    ASSERT_TRUE(grinder.MergeWorker(&worker));
+  }
+
+  ASSERT_EQ(1, grinder.parts_.size());
+  TestProfileGrinder::PartData* part =
+      grinder.FindOrCreatePart(::GetCurrentProcessId(),
+                               ::GetCurrentThreadId());
+  ASSERT_TRUE(part != NULL);
+  EXPECT_EQ("TestThread", part->thread_name_);
+
+  // The metrics of the function are aggregated.
+  ASSERT_EQ(1, part->nodes_.size());
+  TestProfileGrinder::InvocationNodeMap::iterator it = part->nodes_.begin();
+  EXPECT_TRUE(it->first.is_symbol());
+  EXPECT_EQ(kFunctionSymbolId, it->first.symbol_id());
+  EXPECT_EQ(2000u, it->second.metrics.num_calls);
+  EXPECT_EQ(10u, it->second.metrics.cycles_min);
+  EXPECT_EQ(1000u, it->second.metrics.cycles_max);
+  EXPECT_EQ(2u * 1000 * 100, it->second.metrics.cycles_sum);
+
+  // The callers resolve as they do for a single grinder.
+  ASSERT_TRUE(grinder.Grind());
+  EXPECT_EQ(2, part->nodes_.size());
+}
+
 TEST_F(ProfileGrinderTest, ParseEmptyCommandLineSucceeds) {
   TestProfileGrinder grinder;
   EXPECT_TRUE(grinder.ParseCommandLine(&cmd_line_));
@@ -14,14 +14,18 @@
 
 #include "syzygy/grinder/grinders/sample_grinder.h"
 
+#include "base/atomicops.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/block_graph/basic_block_decomposer.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/common/align.h"
 #include "syzygy/grinder/cache_grind_writer.h"
 #include "syzygy/grinder/coverage_data.h"
 #include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/decomposition_cache.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/pe/pe_transform_policy.h"
 
@@ -37,6 +41,26 @@ typedef block_graph::BlockGraph BlockGraph;
 typedef core::AddressRange<core::RelativeAddress, size_t> Range;
 typedef SampleGrinder::HeatMap HeatMap;
 
+// Splits each of @p buckets into @p factor buckets of a fraction of its value.
+void UpsampleBuckets(size_t factor, std::vector<double>* buckets) {
+  DCHECK_LT(0u, factor);
+  DCHECK(buckets != NULL);
+
+  // Grow the buckets in place, and then fill in the scaled values tail first.
+  size_t old_size = buckets->size();
+  size_t new_size = old_size * factor;
+  buckets->resize(new_size);
+  for (size_t i = old_size, j = new_size; i > 0; ) {
+    --i;
+    double new_value = (*buckets)[i] / factor;
+
+    for (size_t k = 0; k < factor; ++k) {
+      --j;
+      (*buckets)[j] = new_value;
+    }
+  }
+}
+
 core::RelativeAddress GetBucketStart(const TraceSampleData* sample_data) {
   DCHECK(sample_data != NULL);
   return core::RelativeAddress(
@@ -57,6 +81,144 @@ size_t IntersectionSize(const Range& range,
   return right - left;
 }
 
+// The number of chunks into which the buckets are split per thread, so that
+// the threads stay busy when the samples are unevenly spread.
+const size_t kHeatChunksPerThread = 8;
+
+// A contiguous run of sample buckets, and the heat they pour into the heat
+// map. The heat is accumulated apart from the heat map, as the ranges at the
+// edges of a chunk may be shared with its neighbours.
+struct HeatChunk {
+  HeatChunk() : bucket_begin(0), bucket_end(0), orphaned(0.0), total(0.0) {}
+
+  // The buckets of the chunk.
+  size_t bucket_begin;
+  size_t bucket_end;
+  // The first range of the heat map that intersects the chunk.
+  HeatMap::iterator first_range;
+  // The heat of the ranges from first_range on.
+  std::vector<double> heat;
+  // The samples that mapped to no range, and all of the samples.
+  double orphaned;
+  double total;
+};
+
+// Attributes the samples of a chunk of buckets to the ranges of a heat map.
+// We walk through the sample buckets, and for each one we find the range of
+// heat map entries that intersect with it. We then divide up the heat to each
+// of these ranges in proportion to the size of their intersection. This only
+// reads the heat map, so that chunks may be attributed concurrently.
+void AttributeHeatChunk(const SampleGrinder::ModuleData& module_data,
+                        HeatMap* heat_map,
+                        HeatChunk* chunk) {
+  DCHECK(heat_map != NULL);
+  DCHECK(chunk != NULL);
+
+  size_t bucket_size = module_data.bucket_size;
+  core::RelativeAddress rva_bucket(
+      module_data.bucket_start + chunk->bucket_begin * bucket_size);
+  Range chunk_range(rva_bucket,
+                    (chunk->bucket_end - chunk->bucket_begin) * bucket_size);
+  chunk->first_range = heat_map->FindFirstIntersection(chunk_range);
+
+  HeatMap::iterator it = chunk->first_range;
+  size_t index = 0;
+  size_t i = chunk->bucket_begin;
+  for (; i < chunk->bucket_end; ++i) {
+    // Advance the current heat map range as long as it's strictly to the left
+    // of the current bucket.
+    while (it != heat_map->end() && it->first.end() <= rva_bucket) {
+      ++it;
+      ++index;
+    }
+    if (it == heat_map->end())
+      break;
+
+    // If the current heat map range is strictly to the right of the current
+    // bucket then those samples have nowhere to be distributed.
+    double samples = module_data.buckets[i];
+    if (rva_bucket + bucket_size <= it->first.start()) {
+      // Tally them up as orphaned samples.
+      chunk->orphaned += samples;
+    } else if (samples != 0) {
+      // Otherwise we heat map ranges that overlap the current bucket.
+
+      // Advance the current heat map range until we're strictly to the right
+      // of the current bucket.
+      HeatMap::iterator it_end = it;
+      size_t index_end = index + 1;
+      ++it_end;
+      while (it_end != heat_map->end() &&
+          it_end->first.start() < rva_bucket + bucket_size) {
+        ++it_end;
+        ++index_end;
+      }
+
+      // Find the total size of the intersections, to be used as a scaling
+      // value for distributing the samples. This is done so that *all* of the
+      // samples are distributed, as the bucket may span space that is not
+      // covered by any heat map ranges.
+      size_t total_intersection = 0;
+      for (HeatMap::iterator it2 = it; it2 != it_end; ++it2) {
+        total_intersection += IntersectionSize(it2->first,
+            rva_bucket, bucket_size);
+      }
+
+      // Now distribute the samples to the various ranges.
+      if (chunk->heat.size() < index_end)
+        chunk->heat.resize(index_end);
+      size_t index2 = index;
+      for (HeatMap::iterator it2 = it; it2 != it_end; ++it2, ++index2) {
+        size_t intersection = IntersectionSize(it2->first,
+            rva_bucket, bucket_size);
+        chunk->heat[index2] += intersection * samples / total_intersection;
+      }
+    }
+
+    // Advance past the current bucket.
+    chunk->total += samples;
+    rva_bucket += bucket_size;
+  }
+
+  // Pick up any trailing orphaned buckets.
+  for (; i < chunk->bucket_end; ++i) {
+    chunk->orphaned += module_data.buckets[i];
+    chunk->total += module_data.buckets[i];
+  }
+}
+
+// Attributes the chunks of buckets on a pool of threads. Each run attributes
+// the next chunk that no thread has claimed yet.
+class HeatChunkAttributor : public base::DelegateSimpleThread::Delegate {
+ public:
+  HeatChunkAttributor(const SampleGrinder::ModuleData& module_data,
+                      HeatMap* heat_map,
+                      std::vector<HeatChunk>* chunks)
+      : module_data_(module_data), heat_map_(heat_map), chunks_(chunks),
+        next_index_(0) {
+    DCHECK(heat_map != NULL);
+    DCHECK(chunks != NULL);
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, chunks_->size());
+    AttributeHeatChunk(module_data_, heat_map_, &(*chunks_)[index]);
+  }
+  // @}
+
+ private:
+  const SampleGrinder::ModuleData& module_data_;
+  HeatMap* heat_map_;
+  std::vector<HeatChunk>* chunks_;
+  base::subtle::Atomic32 next_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeatChunkAttributor);
+};
+
 bool BuildHeatMapForCodeBlock(const pe::PETransformPolicy& policy,
                               const Range& block_range,
                               const BlockGraph::Block* block,
@@ -144,6 +306,7 @@ bool BuildHeatMapForCodeBlock(const pe::PETransformPolicy& policy,
 // basic-block. Non-decomposable code blocks are represented by a single range.
 bool BuildEmptyHeatMap(const SampleGrinder::ModuleKey& module_key,
                        const SampleGrinder::ModuleData& module_data,
+                       const base::FilePath& decomposition_cache,
                        core::StringTable* string_table,
                        HeatMap* heat_map) {
   DCHECK(string_table != NULL);
@@ -156,8 +319,10 @@ bool BuildEmptyHeatMap(const SampleGrinder::ModuleKey& module_key,
     return false;
   }
 
-  // Decompose the module.
+  // Decompose the module, going through the cache so that later runs over
+  // the same module needn't decompose it again.
   pe::Decomposer decomposer(image);
+  decomposer.set_cache_directory(decomposition_cache);
   BlockGraph bg;
   pe::ImageLayout image_layout(&bg);
   LOG(INFO) << "Decomposing module \"" << module_data.module_path.value()
@@ -342,10 +507,15 @@ static_assert(arraysize(SampleGrinder::kAggregationLevelNames) ==
               "Aggregation level names out of sync.");
 
 const char SampleGrinder::kAggregationLevel[] = "aggregation-level";
+const char SampleGrinder::kDecompositionCache[] = "decomposition-cache";
 const char SampleGrinder::kImage[] = "image";
+const char SampleGrinder::kThreads[] = "threads";
 
 SampleGrinder::SampleGrinder()
     : aggregation_level_(kBasicBlock),
+      decomposition_cache_(
+          pe::DecompositionCache::GetDirectoryFromEnvironment()),
+      num_threads_(1),
       parser_(NULL),
       event_handler_errored_(false),
       clock_rate_(0.0) {
@@ -390,6 +560,21 @@ bool SampleGrinder::ParseCommandLine(const base::CommandLine* command_line) {
     image_.GetSignature(&image_signature_);
   }
 
+  if (command_line->HasSwitch(kDecompositionCache)) {
+    decomposition_cache_ =
+        command_line->GetSwitchValuePath(kDecompositionCache);
+  }
+
+  // The samples are attributed on as many threads as the trace files are
+  // parsed on.
+  if (command_line->HasSwitch(kThreads)) {
+    std::string threads = command_line->GetSwitchValueASCII(kThreads);
+    if (!base::StringToSizeT(threads, &num_threads_) || num_threads_ == 0) {
+      LOG(ERROR) << "Invalid number of threads: " << threads << ".";
+      return false;
+    }
+  }
+
   return true;
 }
 
@@ -398,6 +583,36 @@ void SampleGrinder::SetParser(Parser* parser) {
   parser_ = parser;
 }
 
+std::unique_ptr<GrinderInterface> SampleGrinder::CreateWorker() {
+  std::unique_ptr<SampleGrinder> worker(new SampleGrinder());
+  worker->aggregation_level_ = aggregation_level_;
+  worker->image_path_ = image_path_;
+  worker->image_signature_ = image_signature_;
+  return std::move(worker);
+}
+
+bool SampleGrinder::MergeWorker(GrinderInterface* worker) {
+  DCHECK(worker != NULL);
+  SampleGrinder* sample_worker = static_cast<SampleGrinder*>(worker);
+
+  if (sample_worker->event_handler_errored_)
+    event_handler_errored_ = true;
+
+  ModuleDataMap::iterator worker_it = sample_worker->module_data_.begin();
+  for (; worker_it != sample_worker->module_data_.end(); ++worker_it) {
+    ModuleData& module_data = module_data_[worker_it->first];
+    if (module_data.module_path.empty())
+      module_data.module_path = worker_it->second.module_path;
+    if (!MergeModuleData(&worker_it->second, &module_data)) {
+      LOG(ERROR) << "Failed to merge sample data for module \""
+                 << module_data.module_path.value() << "\".";
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool SampleGrinder::Grind() {
   if (event_handler_errored_) {
     LOG(WARNING) << "Failed to handle all TraceSampleData records, results "
@@ -434,7 +649,8 @@ bool SampleGrinder::Grind() {
       // the image to get compilands, functions and basic blocks.
       // TODO(chrisha): We shouldn't need full decomposition for this.
       empty_heat_map_built = BuildEmptyHeatMap(
-          mod_it->first, mod_it->second, &string_table_, &heat_map_);
+          mod_it->first, mod_it->second, decomposition_cache_,
+          &string_table_, &heat_map_);
     }
 
     if (!empty_heat_map_built) {
@@ -447,7 +663,7 @@ bool SampleGrinder::Grind() {
     // did not map to code blocks then output a warning.
     double total = 0.0;
     double orphaned = IncrementHeatMapFromModuleData(
-        mod_it->second, &heat_map_, &total);
+        mod_it->second, num_threads_, &heat_map_, &total);
     if (orphaned > 0) {
       LOG(WARNING) << base::StringPrintf("%.2f%% (%.4f s) ",
                                           orphaned / total,
@@ -605,21 +821,8 @@ void SampleGrinder::UpsampleModuleData(
   if (module_data->bucket_size <= sample_data->bucket_size)
     return;
 
-  // Grow the buckets in place, and then fill in the scaled values tail first.
-  std::vector<double>& buckets = module_data->buckets;
-  size_t old_size = buckets.size();
-  size_t factor = module_data->bucket_size / sample_data->bucket_size;
-  size_t new_size = old_size * factor;
-  buckets.resize(new_size);
-  for (size_t i = old_size, j = new_size; i > 0; ) {
-    --i;
-    double new_value = buckets[i] / factor;
-
-    for (size_t k = 0; k < factor; ++k) {
-      --j;
-      buckets[j] = new_value;
-    }
-  }
+  UpsampleBuckets(module_data->bucket_size / sample_data->bucket_size,
+                  &module_data->buckets);
 
   // Update the bucket size.
   module_data->bucket_size = sample_data->bucket_size;
@@ -627,6 +830,43 @@ void SampleGrinder::UpsampleModuleData(
   return;
 }
 
+bool SampleGrinder::MergeModuleData(SampleGrinder::ModuleData* worker_data,
+                                    SampleGrinder::ModuleData* module_data) {
+  DCHECK(worker_data != NULL);
+  DCHECK(module_data != NULL);
+
+  if (worker_data->bucket_size == 0)
+    return true;
+  if (module_data->bucket_size == 0) {
+    *module_data = std::move(*worker_data);
+    return true;
+  }
+
+  if (worker_data->bucket_start != module_data->bucket_start) {
+    LOG(ERROR) << "Sample data have inconsistent bucket starts.";
+    return false;
+  }
+
+  // Bring both to the finer of the resolutions.
+  if (worker_data->bucket_size < module_data->bucket_size) {
+    UpsampleBuckets(module_data->bucket_size / worker_data->bucket_size,
+                    &module_data->buckets);
+    module_data->bucket_size = worker_data->bucket_size;
+  } else if (module_data->bucket_size < worker_data->bucket_size) {
+    UpsampleBuckets(worker_data->bucket_size / module_data->bucket_size,
+                    &worker_data->buckets);
+    worker_data->bucket_size = module_data->bucket_size;
+  }
+
+  // The bucket counts of coarser data may round the module size up.
+  if (module_data->buckets.size() < worker_data->buckets.size())
+    module_data->buckets.resize(worker_data->buckets.size());
+  for (size_t i = 0; i < worker_data->buckets.size(); ++i)
+    module_data->buckets[i] += worker_data->buckets[i];
+
+  return true;
+}
+
 // Increments the module data with the given sample data. Returns false and
 // logs if this is not possible due to invalid data.
 bool SampleGrinder::IncrementModuleData(
@@ -690,72 +930,48 @@ bool SampleGrinder::IncrementModuleData(
 
 double SampleGrinder::IncrementHeatMapFromModuleData(
     const SampleGrinder::ModuleData& module_data,
+    size_t num_threads,
     HeatMap* heat_map,
     double* total_samples) {
+  DCHECK_LT(0u, num_threads);
   DCHECK(heat_map != NULL);
 
+  // Split the buckets into chunks, each of which finds its first range
+  // through the index of the frozen heat map.
+  size_t num_buckets = module_data.buckets.size();
+  size_t num_chunks = 1;
+  if (num_threads > 1)
+    num_chunks = std::min(num_buckets, num_threads * kHeatChunksPerThread);
+  std::vector<HeatChunk> chunks(std::max<size_t>(num_chunks, 1));
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    chunks[i].bucket_begin = num_buckets * i / chunks.size();
+    chunks[i].bucket_end = num_buckets * (i + 1) / chunks.size();
+  }
+
+  heat_map->Freeze();
+  if (chunks.size() == 1) {
+    AttributeHeatChunk(module_data, heat_map, &chunks[0]);
+  } else {
+    HeatChunkAttributor attributor(module_data, heat_map, &chunks);
+    base::DelegateSimpleThreadPool pool(
+        "SampleGrinder",
+        static_cast<int>(std::min(num_threads, chunks.size())));
+    pool.Start();
+    pool.AddWork(&attributor, static_cast<int>(chunks.size()));
+    pool.JoinAll();
+  }
+
+  // Pour the heat of the chunks into the heat map, in order.
   double orphaned_samples = 0.0;
   double temp_total_samples = 0.0;
-
-  // We walk through the sample buckets, and for each one we find the range of
-  // heat map entries that intersect with it. We then divide up the heat to
-  // each of these ranges in proportion to the size of their intersection.
-  core::RelativeAddress rva_bucket(module_data.bucket_start);
-  HeatMap::iterator it = heat_map->begin();
-  size_t i = 0;
-  for (; i < module_data.buckets.size(); ++i) {
-    // Advance the current heat map range as long as it's strictly to the left
-    // of the current bucket.
-    while (it != heat_map->end() && it->first.end() <= rva_bucket)
-      ++it;
-    if (it == heat_map->end())
-      break;
-
-    // If the current heat map range is strictly to the right of the current
-    // bucket then those samples have nowhere to be distributed.
-    if (rva_bucket + module_data.bucket_size <= it->first.start()) {
-      // Tally them up as orphaned samples.
-      orphaned_samples += module_data.buckets[i];
-    } else {
-      // Otherwise we heat map ranges that overlap the current bucket.
-
-      // Advance the current heat map range until we're strictly to the right
-      // of the current bucket.
-      HeatMap::iterator it_end = it;
-      ++it_end;
-      while (it_end != heat_map->end() &&
-          it_end->first.start() < rva_bucket + module_data.bucket_size) {
-        ++it_end;
-      }
-
-      // Find the total size of the intersections, to be used as a scaling
-      // value for distributing the samples. This is done so that *all* of the
-      // samples are distributed, as the bucket may span space that is not
-      // covered by any heat map ranges.
-      size_t total_intersection = 0;
-      for (HeatMap::iterator it2 = it; it2 != it_end; ++it2) {
-        total_intersection += IntersectionSize(it2->first,
-            rva_bucket, module_data.bucket_size);
-      }
-
-      // Now distribute the samples to the various ranges.
-      for (HeatMap::iterator it2 = it; it2 != it_end; ++it2) {
-        size_t intersection = IntersectionSize(it2->first,
-            rva_bucket, module_data.bucket_size);
-        it2->second.heat += intersection * module_data.buckets[i] /
-            total_intersection;
-      }
+  for (const HeatChunk& chunk : chunks) {
+    HeatMap::iterator it = chunk.first_range;
+    for (size_t i = 0; i < chunk.heat.size(); ++i, ++it) {
+      DCHECK(it != heat_map->end());
+      it->second.heat += chunk.heat[i];
     }
-
-    // Advance past the current bucket.
-    temp_total_samples += module_data.buckets[i];
-    rva_bucket += module_data.bucket_size;
-  }
-
-  // Pick up any trailing orphaned buckets.
-  for (; i < module_data.buckets.size(); ++i) {
-    orphaned_samples += module_data.buckets[i];
-    temp_total_samples += module_data.buckets[i];
+    orphaned_samples += chunk.orphaned;
+    temp_total_samples += chunk.total;
   }
 
   if (total_samples != NULL)
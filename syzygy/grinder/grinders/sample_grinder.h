@@ -53,6 +53,8 @@ class SampleGrinder : public GrinderInterface {
   // @{
   virtual bool ParseCommandLine(const base::CommandLine* command_line) override;
   virtual void SetParser(Parser* parser) override;
+  virtual std::unique_ptr<GrinderInterface> CreateWorker() override;
+  virtual bool MergeWorker(GrinderInterface* worker) override;
   virtual bool Grind() override;
   virtual bool OutputData(FILE* file) override;
   // @}
@@ -73,7 +75,9 @@ class SampleGrinder : public GrinderInterface {
   // @name Parameter names.
   // @{
   static const char kAggregationLevel[];
+  static const char kDecompositionCache[];
   static const char kImage[];
+  static const char kThreads[];
   // @}
 
   // Forward declarations. These are public so that they are accessible by
@@ -116,6 +120,15 @@ class SampleGrinder : public GrinderInterface {
       const TraceSampleData* sample_data,
       SampleGrinder::ModuleData* module_data);
 
+  // Adds the aggregate samples of @p worker_data to @p module_data, at the
+  // finer of their resolutions.
+  // @param worker_data The module data to be added. It may be upsampled.
+  // @param module_data The module data to be incremented.
+  // @returns true on success, false if the module data are inconsistent.
+  // @note This is exposed for unit testing.
+  static bool MergeModuleData(SampleGrinder::ModuleData* worker_data,
+                              SampleGrinder::ModuleData* module_data);
+
   // Updates the @p module_data with the samples from @p sample_data. The
   // @p module_data must already be at sufficient resolution to accept the
   // data in @p sample_data. This can fail if the @p sample_data and the
@@ -131,8 +144,11 @@ class SampleGrinder : public GrinderInterface {
 
   // Given a populated @p heat_map and aggregate @p module_data, estimates heat
   // for each range in the @p heat_map. The values represent an estimate of
-  // amount of time spent in the range, in seconds.
+  // amount of time spent in the range, in seconds. The buckets are split into
+  // chunks of contiguous addresses, which are attributed in parallel.
   // @param module_data Aggregate module data.
+  // @param num_threads The maximum number of threads on which to attribute
+  //     the buckets.
   // @param heat A pre-populated address space representing the basic blocks of
   //     the module in question.
   // @param total_samples The total number of samples processed will be returned
@@ -141,6 +157,7 @@ class SampleGrinder : public GrinderInterface {
   //     to any range in the heat map.
   static double IncrementHeatMapFromModuleData(
       const SampleGrinder::ModuleData& module_data,
+      size_t num_threads,
       HeatMap* heat_map,
       double* total_samples);
 
@@ -163,6 +180,14 @@ class SampleGrinder : public GrinderInterface {
   pe::PEFile image_;
   pe::PEFile::Signature image_signature_;
 
+  // The directory of the decomposition cache shared with the other tools. If
+  // empty, the modules are decomposed anew.
+  base::FilePath decomposition_cache_;
+
+  // The maximum number of threads on which to attribute the samples to the
+  // heat map.
+  size_t num_threads_;
+
   // Points to the parser that is feeding us events. Used to get module
   // information.
   Parser* parser_;
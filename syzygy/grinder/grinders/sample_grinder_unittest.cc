@@ -40,6 +40,7 @@ class TestSampleGrinder : public SampleGrinder {
  public:
   // Functions.
   using SampleGrinder::UpsampleModuleData;
+  using SampleGrinder::MergeModuleData;
   using SampleGrinder::IncrementModuleData;
   using SampleGrinder::IncrementHeatMapFromModuleData;
   using SampleGrinder::RollUpByName;
@@ -51,6 +52,7 @@ class TestSampleGrinder : public SampleGrinder {
   using SampleGrinder::heat_map_;
   using SampleGrinder::name_heat_map_;
   using SampleGrinder::line_info_;
+  using SampleGrinder::num_threads_;
 };
 
 class SampleGrinderTest : public testing::PELibUnitTest {
@@ -290,6 +292,54 @@ TEST_F(SampleGrinderTest, UpsampleModuleData) {
   EXPECT_DOUBLE_EQ(2.0, BucketSum(module_data));
 }
 
+TEST_F(SampleGrinderTest, MergeModuleData) {
+  SampleGrinder::ModuleData module_data;
+  SampleGrinder::ModuleData worker_data;
+
+  // Empty worker data merge trivially.
+  EXPECT_TRUE(TestSampleGrinder::MergeModuleData(&worker_data, &module_data));
+  EXPECT_EQ(0u, module_data.bucket_size);
+
+  // Data are taken as is by empty module data.
+  worker_data.bucket_start = core::RelativeAddress(0x1000);
+  worker_data.bucket_size = 8;
+  worker_data.buckets.resize(4);
+  worker_data.buckets[0] = 2.0;
+  EXPECT_TRUE(TestSampleGrinder::MergeModuleData(&worker_data, &module_data));
+  EXPECT_EQ(8u, module_data.bucket_size);
+  ASSERT_EQ(4u, module_data.buckets.size());
+  EXPECT_DOUBLE_EQ(2.0, module_data.buckets[0]);
+
+  // Finer worker data upsample the module data.
+  worker_data.bucket_start = core::RelativeAddress(0x1000);
+  worker_data.bucket_size = 4;
+  worker_data.buckets.assign(8, 0.0);
+  worker_data.buckets[1] = 1.0;
+  EXPECT_TRUE(TestSampleGrinder::MergeModuleData(&worker_data, &module_data));
+  EXPECT_EQ(4u, module_data.bucket_size);
+  ASSERT_EQ(8u, module_data.buckets.size());
+  EXPECT_DOUBLE_EQ(1.0, module_data.buckets[0]);
+  EXPECT_DOUBLE_EQ(2.0, module_data.buckets[1]);
+  EXPECT_DOUBLE_EQ(3.0, BucketSum(module_data));
+
+  // Coarser worker data are upsampled themselves.
+  worker_data.bucket_start = core::RelativeAddress(0x1000);
+  worker_data.bucket_size = 16;
+  worker_data.buckets.assign(2, 0.0);
+  worker_data.buckets[1] = 4.0;
+  EXPECT_TRUE(TestSampleGrinder::MergeModuleData(&worker_data, &module_data));
+  EXPECT_EQ(4u, module_data.bucket_size);
+  ASSERT_EQ(8u, module_data.buckets.size());
+  EXPECT_DOUBLE_EQ(1.0, module_data.buckets[4]);
+  EXPECT_DOUBLE_EQ(7.0, BucketSum(module_data));
+
+  // Data with different bucket starts can't be merged.
+  worker_data.bucket_start = core::RelativeAddress(0x2000);
+  worker_data.bucket_size = 4;
+  worker_data.buckets.assign(8, 1.0);
+  EXPECT_FALSE(TestSampleGrinder::MergeModuleData(&worker_data, &module_data));
+}
+
 TEST_F(SampleGrinderTest, IncrementModuleData) {
   ASSERT_NO_FATAL_FAILURE(PrepareDummySampleDataBuffer(5));
   ASSERT_TRUE(sample_data_ != NULL);
@@ -401,21 +451,28 @@ TEST_F(SampleGrinderTest, IncrementHeatMapFromModuleData) {
   ASSERT_TRUE(heat_map.Insert(Range(RVA(28), 1), kData));  // H.
   ASSERT_TRUE(heat_map.Insert(Range(RVA(31), 1), kData));  // I.
 
-  double total_samples = 0;
-  double orphaned_samples = TestSampleGrinder::IncrementHeatMapFromModuleData(
-      module_data, &heat_map, &total_samples);
-  EXPECT_DOUBLE_EQ(1.0, orphaned_samples);
-  EXPECT_DOUBLE_EQ(9.0, total_samples);
-
   // We expect the heat to have been distributed to the ranges in the following
-  // quantities.
+  // quantities, whether the buckets are attributed in a single chunk or on
+  // several threads, where each bucket is a chunk of its own and G spans two
+  // of them.
   const double kHeat[] = { /* A */ 1.0, /* B */ 1.0, /* C */ 1.0,
                            /* D */ 1.0, /* E */ 0.5, /* F */ 0.5,
                            /* G */ 2.0, /* H */ 0.5, /* I */ 0.5 };
-  ASSERT_EQ(arraysize(kHeat), heat_map.size());
-  HeatMap::const_iterator it = heat_map.begin();
-  for (size_t i = 0; it != heat_map.end(); ++it, ++i)
-    EXPECT_DOUBLE_EQ(kHeat[i], it->second.heat);
+  const size_t kNumThreads[] = { 1, 4 };
+  for (size_t num_threads : kNumThreads) {
+    HeatMap thread_heat_map(heat_map);
+    double total_samples = 0;
+    double orphaned_samples =
+        TestSampleGrinder::IncrementHeatMapFromModuleData(
+            module_data, num_threads, &thread_heat_map, &total_samples);
+    EXPECT_DOUBLE_EQ(1.0, orphaned_samples);
+    EXPECT_DOUBLE_EQ(9.0, total_samples);
+
+    ASSERT_EQ(arraysize(kHeat), thread_heat_map.size());
+    HeatMap::const_iterator it = thread_heat_map.begin();
+    for (size_t i = 0; it != thread_heat_map.end(); ++it, ++i)
+      EXPECT_DOUBLE_EQ(kHeat[i], it->second.heat) << num_threads;
+  }
 }
 
 TEST_F(SampleGrinderTest, RollUpByName) {
@@ -460,6 +517,20 @@ TEST_F(SampleGrinderTest, ParseMinimalCommandLineSucceeds) {
   EXPECT_EQ(SampleGrinder::kBasicBlock, g.aggregation_level_);
 }
 
+TEST_F(SampleGrinderTest, ParseCommandLineThreads) {
+  cmd_line_.AppendSwitchPath(SampleGrinder::kImage, test_dll_path_);
+  cmd_line_.AppendSwitchASCII(SampleGrinder::kThreads, "4");
+  TestSampleGrinder g;
+  EXPECT_TRUE(g.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(4u, g.num_threads_);
+
+  base::CommandLine bad_cmd_line(base::FilePath(L"sample_grinder.exe"));
+  bad_cmd_line.AppendSwitchPath(SampleGrinder::kImage, test_dll_path_);
+  bad_cmd_line.AppendSwitchASCII(SampleGrinder::kThreads, "0");
+  TestSampleGrinder g2;
+  EXPECT_FALSE(g2.ParseCommandLine(&bad_cmd_line));
+}
+
 TEST_F(SampleGrinderTest, ParseCommandLineAggregationLevel) {
   // Test command line without specifying '--image'.
 
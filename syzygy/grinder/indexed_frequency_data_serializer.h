@@ -82,6 +82,9 @@ class IndexedFrequencyDataSerializer {
   // Sets the pretty-printing status.
   void set_pretty_print(bool value) { pretty_print_ = value; }
 
+  // @returns the pretty-printing status.
+  bool pretty_print() const { return pretty_print_; }
+
   // Saves the given frequency map to a file at @p file_path.
   bool SaveAsJson(const ModuleIndexedFrequencyMap& frequency_map,
                   const base::FilePath& file_path);
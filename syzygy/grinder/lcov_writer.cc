@@ -14,17 +14,51 @@
 
 #include "syzygy/grinder/lcov_writer.h"
 
-#include "base/files/file_util.h"
+#include "base/sys_info.h"
+#include "syzygy/grinder/coverage_record_writer.h"
 
 namespace grinder {
 
+namespace {
+
+// Formats the LCOV record of a source file.
+void FormatLcovRecord(const std::string& source_file,
+                      const CoverageData::SourceFileCoverageData& data,
+                      std::string* record) {
+  DCHECK(record != NULL);
+
+  record->append("SF:");
+  record->append(source_file);
+  record->push_back('\n');
+
+  // Iterate over the line execution data, keeping summary statistics as we
+  // go.
+  size_t lines_executed = 0;
+  for (const auto& line : data.line_execution_count_map) {
+    record->append("DA:");
+    AppendDecimal(line.first, record);
+    record->push_back(',');
+    AppendDecimal(line.second, record);
+    record->push_back('\n');
+    if (line.second > 0)
+      ++lines_executed;
+  }
+
+  // Output the summary statistics for this file.
+  record->append("LH:");
+  AppendDecimal(lines_executed, record);
+  record->append("\nLF:");
+  AppendDecimal(data.line_execution_count_map.size(), record);
+  record->append("\nend_of_record\n");
+}
+
+}  // namespace
+
 bool WriteLcovCoverageFile(const CoverageData& coverage,
                            const base::FilePath& path) {
-  base::ScopedFILE file(base::OpenFile(path, "wb"));
-  if (file.get() == NULL) {
-    LOG(ERROR) << "Failed to open file for writing: " << path.value();
+  base::ScopedFILE file;
+  if (!OpenCoverageFileForWriting(path, &file))
     return false;
-  }
 
   if (!WriteLcovCoverageFile(coverage, file.get())) {
     LOG(ERROR) << "Failed to write LCOV file: " << path.value();
@@ -37,38 +71,8 @@ bool WriteLcovCoverageFile(const CoverageData& coverage,
 bool WriteLcovCoverageFile(const CoverageData& coverage, FILE* file) {
   DCHECK(file != NULL);
 
-  CoverageData::SourceFileCoverageDataMap::const_iterator source_it =
-      coverage.source_file_coverage_data_map().begin();
-  CoverageData::SourceFileCoverageDataMap::const_iterator source_it_end =
-      coverage.source_file_coverage_data_map().end();
-  for (; source_it != source_it_end; ++source_it) {
-    if (::fprintf(file, "SF:%s\n", source_it->first.c_str()) < 0)
-      return false;
-
-    // Iterate over the line execution data, keeping summary statistics as we
-    // go.
-    size_t lines_executed = 0;
-    CoverageData::LineExecutionCountMap::const_iterator line_it =
-        source_it->second.line_execution_count_map.begin();
-    CoverageData::LineExecutionCountMap::const_iterator line_it_end =
-        source_it->second.line_execution_count_map.end();
-    for (; line_it != line_it_end; ++line_it) {
-      if (::fprintf(file, "DA:%d,%d\n", line_it->first, line_it->second) < 0)
-        return false;
-      if (line_it->second > 0)
-        ++lines_executed;
-    }
-
-    // Output the summary statistics for this file.
-    if (::fprintf(file, "LH:%d\n", lines_executed) < 0 ||
-        ::fprintf(file, "LF:%d\n",
-                  source_it->second.line_execution_count_map.size()) < 0 ||
-        ::fprintf(file, "end_of_record\n") < 0) {
-      return false;
-    }
-  }
-
-  return true;
+  return WriteCoverageRecords(coverage, &FormatLcovRecord,
+                              base::SysInfo::NumberOfProcessors(), file);
 }
 
 }  // namespace grinder
@@ -16,13 +16,19 @@
 
 #include <dia2.h>
 #include <algorithm>
+#include <cstring>
 #include <limits>
 
+#include "base/files/file_util.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
 #include "base/win/scoped_bstr.h"
 #include "base/win/scoped_comptr.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/core/address_range.h"
+#include "syzygy/pdb/pdb_util.h"
+#include "syzygy/pe/decomposition_cache.h"
 #include "syzygy/pe/dia_util.h"
 
 namespace grinder {
@@ -35,6 +41,74 @@ using base::win::ScopedComPtr;
 typedef core::AddressRange<core::RelativeAddress, size_t> RelativeAddressRange;
 typedef std::map<DWORD, const std::string*> SourceFileMap;
 
+// The signature and version of line information cache entries. Bump the
+// version whenever the format of Encode changes.
+const uint32_t kCacheEntrySignature = 0x494C5A53;  // 'SZLI'.
+const uint32_t kCacheEntryVersion = 1;
+
+// The extension of the line information cache entries.
+const char kCacheEntryExtension[] = ".li";
+
+// The header of a line information cache entry, followed by the output of
+// LineInfo::Encode.
+struct CacheEntryHeader {
+  uint32_t signature;
+  uint32_t version;
+  GUID pdb_signature;
+  uint32_t pdb_age;
+};
+
+// Appends @p value to @p data as a little-endian base-128 varint.
+void AppendVarint(uint32_t value, std::vector<uint8_t>* data) {
+  DCHECK(data != NULL);
+  while (value >= 0x80) {
+    data->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  data->push_back(static_cast<uint8_t>(value));
+}
+
+// Reads a varint written by AppendVarint from [*data, end), advancing @p data
+// past it.
+bool ReadVarint(const uint8_t** data, const uint8_t* end, uint32_t* value) {
+  DCHECK(data != NULL);
+  DCHECK(value != NULL);
+
+  *value = 0;
+  for (size_t shift = 0; shift < 32; shift += 7) {
+    if (*data == end)
+      return false;
+    uint8_t byte = *(*data)++;
+    *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Maps signed deltas to unsigned values so that small deltas of either sign
+// encode to short varints.
+uint32_t ZigZagEncode(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+      static_cast<uint32_t>(value >> 31);
+}
+
+int32_t ZigZagDecode(uint32_t value) {
+  return static_cast<int32_t>((value >> 1) ^ (0u - (value & 1)));
+}
+
+base::FilePath GetCacheEntryPath(const base::FilePath& cache_directory,
+                                 const pdb::PdbInfoHeader70& pdb_header) {
+  const GUID& guid = pdb_header.signature;
+  std::string name = base::StringPrintf("%08X%04X%04X",
+                                        guid.Data1, guid.Data2, guid.Data3);
+  for (size_t i = 0; i < arraysize(guid.Data4); ++i)
+    base::StringAppendF(&name, "%02X", guid.Data4[i]);
+  base::StringAppendF(&name, "-%X%s", pdb_header.pdb_age,
+                      kCacheEntryExtension);
+  return cache_directory.AppendASCII(name);
+}
+
 bool GetDiaSessionForPdb(const base::FilePath& pdb_path,
                          IDiaDataSource* source,
                          IDiaSession** session) {
@@ -133,6 +207,184 @@ struct SourceLineAddressComparator {
 }  // namespace
 
 bool LineInfo::Init(const base::FilePath& pdb_path) {
+  return Init(pdb_path, pe::DecompositionCache::GetDirectoryFromEnvironment());
+}
+
+bool LineInfo::Init(const base::FilePath& pdb_path,
+                    const base::FilePath& cache_directory) {
+  if (cache_directory.empty())
+    return InitFromPdb(pdb_path);
+
+  // Without a header there's no key, and DIA gets to report the problem.
+  pdb::PdbInfoHeader70 pdb_header = {};
+  if (!pdb::ReadPdbHeader(pdb_path, &pdb_header))
+    return InitFromPdb(pdb_path);
+  base::FilePath entry_path = GetCacheEntryPath(cache_directory, pdb_header);
+
+  // Decode the entry straight out of a mapping of it. A missing entry is the
+  // common case, so it goes unreported.
+  {
+    base::MemoryMappedFile entry;
+    if (base::PathExists(entry_path) && entry.Initialize(entry_path)) {
+      CacheEntryHeader header = {};
+      if (entry.length() >= sizeof(header))
+        ::memcpy(&header, entry.data(), sizeof(header));
+      if (header.signature == kCacheEntrySignature &&
+          header.version == kCacheEntryVersion &&
+          header.pdb_signature == pdb_header.signature &&
+          header.pdb_age == pdb_header.pdb_age &&
+          Decode(entry.data() + sizeof(header),
+                 entry.length() - sizeof(header))) {
+        return true;
+      }
+      LOG(WARNING) << "Ignoring invalid line information cache entry: "
+                   << entry_path.value();
+    }
+  }
+
+  if (!InitFromPdb(pdb_path))
+    return false;
+
+  CacheEntryHeader header = {};
+  header.signature = kCacheEntrySignature;
+  header.version = kCacheEntryVersion;
+  header.pdb_signature = pdb_header.signature;
+  header.pdb_age = pdb_header.pdb_age;
+  std::vector<uint8_t> data(reinterpret_cast<const uint8_t*>(&header),
+                            reinterpret_cast<const uint8_t*>(&header + 1));
+  Encode(&data);
+
+  // The entry is written to a temporary file that is then moved into place,
+  // so concurrent readers never see a partial entry. A cache that can't be
+  // updated only costs later runs some time.
+  base::FilePath temp_path;
+  if (!base::CreateDirectory(cache_directory) ||
+      !base::CreateTemporaryFileInDir(cache_directory, &temp_path)) {
+    LOG(WARNING) << "Unable to create line information cache entry in: "
+                 << cache_directory.value();
+    return true;
+  }
+  base::File::Error error;
+  if (base::WriteFile(temp_path, reinterpret_cast<const char*>(data.data()),
+                      static_cast<int>(data.size())) !=
+          static_cast<int>(data.size()) ||
+      !base::ReplaceFile(temp_path, entry_path, &error)) {
+    LOG(WARNING) << "Unable to write line information cache entry: "
+                 << entry_path.value();
+    base::DeleteFile(temp_path, false);
+  }
+
+  return true;
+}
+
+void LineInfo::Encode(std::vector<uint8_t>* data) const {
+  DCHECK(data != NULL);
+
+  // Source files are referred to by their index in source_files_.
+  std::map<const std::string*, uint32_t> file_indices;
+  AppendVarint(static_cast<uint32_t>(source_files_.size()), data);
+  for (const std::string& source_file : source_files_) {
+    uint32_t index = static_cast<uint32_t>(file_indices.size());
+    file_indices[&source_file] = index;
+    AppendVarint(static_cast<uint32_t>(source_file.size()), data);
+    data->insert(data->end(), source_file.begin(), source_file.end());
+  }
+
+  // Lines are sorted by address, so their address deltas are never negative.
+  uint32_t previous_address = 0;
+  uint32_t previous_line_number = 0;
+  AppendVarint(static_cast<uint32_t>(source_lines_.size()), data);
+  for (const SourceLine& source_line : source_lines_) {
+    DCHECK_LE(previous_address, source_line.address.value());
+    DCHECK(file_indices.find(source_line.source_file_name) !=
+           file_indices.end());
+    uint32_t line_number = static_cast<uint32_t>(source_line.line_number);
+    AppendVarint(source_line.address.value() - previous_address, data);
+    AppendVarint(static_cast<uint32_t>(source_line.size), data);
+    AppendVarint(file_indices[source_line.source_file_name], data);
+    AppendVarint(ZigZagEncode(
+        static_cast<int32_t>(line_number - previous_line_number)), data);
+    previous_address = source_line.address.value();
+    previous_line_number = line_number;
+  }
+}
+
+bool LineInfo::Decode(const uint8_t* data, size_t size) {
+  DCHECK(data != NULL || size == 0);
+
+  source_files_.clear();
+  source_lines_.clear();
+
+  const uint8_t* end = data + size;
+  uint32_t file_count = 0;
+  if (!ReadVarint(&data, end, &file_count) ||
+      file_count > static_cast<size_t>(end - data)) {
+    LOG(ERROR) << "Invalid line information source file count.";
+    return false;
+  }
+
+  std::vector<const std::string*> source_file_names;
+  source_file_names.reserve(file_count);
+  for (uint32_t i = 0; i < file_count; ++i) {
+    uint32_t length = 0;
+    if (!ReadVarint(&data, end, &length) ||
+        length > static_cast<size_t>(end - data)) {
+      LOG(ERROR) << "Invalid line information source file name.";
+      source_files_.clear();
+      return false;
+    }
+    SourceFileSet::const_iterator it = source_files_.insert(
+        std::string(reinterpret_cast<const char*>(data), length)).first;
+    source_file_names.push_back(&(*it));
+    data += length;
+  }
+
+  // Each line takes at least 4 bytes.
+  uint32_t line_count = 0;
+  if (!ReadVarint(&data, end, &line_count) ||
+      line_count > static_cast<size_t>(end - data) / 4) {
+    LOG(ERROR) << "Invalid line information source line count.";
+    source_files_.clear();
+    return false;
+  }
+
+  source_lines_.reserve(line_count);
+  uint32_t address = 0;
+  uint32_t line_number = 0;
+  for (uint32_t i = 0; i < line_count; ++i) {
+    uint32_t address_delta = 0;
+    uint32_t line_size = 0;
+    uint32_t file_index = 0;
+    uint32_t line_number_delta = 0;
+    if (!ReadVarint(&data, end, &address_delta) ||
+        !ReadVarint(&data, end, &line_size) ||
+        !ReadVarint(&data, end, &file_index) ||
+        !ReadVarint(&data, end, &line_number_delta) ||
+        file_index >= source_file_names.size()) {
+      LOG(ERROR) << "Invalid line information source line.";
+      source_files_.clear();
+      source_lines_.clear();
+      return false;
+    }
+    address += address_delta;
+    line_number += ZigZagDecode(line_number_delta);
+    source_lines_.push_back(SourceLine(source_file_names[file_index],
+                                       line_number,
+                                       core::RelativeAddress(address),
+                                       line_size));
+  }
+
+  if (data != end) {
+    LOG(ERROR) << "Unexpected data after line information.";
+    source_files_.clear();
+    source_lines_.clear();
+    return false;
+  }
+
+  return true;
+}
+
+bool LineInfo::InitFromPdb(const base::FilePath& pdb_path) {
   ScopedComPtr<IDiaDataSource> source;
   if (!pe::CreateDiaSource(source.Receive()))
     return false;
@@ -277,4 +529,27 @@ bool LineInfo::Visit(
   return true;
 }
 
+bool LineInfo::AddVisits(const LineInfo& other) {
+  if (other.source_lines_.size() != source_lines_.size()) {
+    LOG(ERROR) << "Mismatched line information.";
+    return false;
+  }
+  for (size_t i = 0; i < source_lines_.size(); ++i) {
+    if (other.source_lines_[i].address != source_lines_[i].address ||
+        other.source_lines_[i].line_number != source_lines_[i].line_number) {
+      LOG(ERROR) << "Mismatched line information.";
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < source_lines_.size(); ++i) {
+    uint32_t count = other.source_lines_[i].visit_count;
+    source_lines_[i].visit_count =
+        std::min(source_lines_[i].visit_count,
+                 std::numeric_limits<uint32_t>::max() - count) + count;
+  }
+
+  return true;
+}
+
 }  // namespace grinder
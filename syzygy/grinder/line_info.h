@@ -18,6 +18,11 @@
 #ifndef SYZYGY_GRINDER_LINE_INFO_H_
 #define SYZYGY_GRINDER_LINE_INFO_H_
 
+#include <stdint.h>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "base/files/file_path.h"
 #include "syzygy/core/address.h"
 #include "syzygy/core/address_space.h"
@@ -44,10 +49,38 @@ class LineInfo {
   typedef std::vector<SourceLine> SourceLines;
 
   // Initializes this LineInfo object with data read from the provided PDB.
+  // This goes through the line information cache in the directory named by
+  // pe::DecompositionCache::kCacheDirectoryEnvVar, if it's set.
   // @param pdb_path the PDB whose line information is to be read.
   // @returns true on success, false otherwise.
   bool Init(const base::FilePath& pdb_path);
 
+  // Initializes this LineInfo object with data read from the provided PDB,
+  // going through a cache. Extracting line information through DIA is slow,
+  // so it's stored in the compact format of Encode in @p cache_directory the
+  // first time a PDB is read, and later read back from there. Entries are
+  // keyed by the GUID and age of the PDB.
+  // @param pdb_path the PDB whose line information is to be read.
+  // @param cache_directory the directory holding the cache entries. If empty,
+  //     the PDB is read directly.
+  // @returns true on success, false otherwise.
+  bool Init(const base::FilePath& pdb_path,
+            const base::FilePath& cache_directory);
+
+  // Encodes the line information in a compact binary format. Source lines are
+  // stored in order as variable-length deltas of their address and line
+  // number, with the index of their source file. Visit counts aren't stored.
+  // @param data receives the encoded line information.
+  void Encode(std::vector<uint8_t>* data) const;
+
+  // Replaces the line information with that decoded from the output of
+  // Encode. The visit counts of all lines are zero.
+  // @param data the encoded line information.
+  // @param size the size of @p data, in bytes.
+  // @returns true on success, false if @p data is invalid, in which case
+  //     this LineInfo object is left empty.
+  bool Decode(const uint8_t* data, size_t size);
+
   // Visits the given address range. A partial visit of the code associated
   // with a line is considered as a visit of that line.
   // @param address the starting address of the address range.
@@ -55,6 +88,13 @@ class LineInfo {
   // @param the number of times to visit this line.
   bool Visit(core::RelativeAddress address, size_t size, size_t count);
 
+  // Adds the visit counts of another LineInfo object to those of this one.
+  // The two must hold the line information of the same PDB.
+  // @param other the LineInfo object whose visit counts are to be added.
+  // @returns true on success, false if @p other doesn't hold the same source
+  //     lines, in which case this object is left unchanged.
+  bool AddVisits(const LineInfo& other);
+
   // @name Accessors.
   // @{
   const SourceFileSet& source_files() const { return source_files_; }
@@ -62,6 +102,11 @@ class LineInfo {
   // @}
 
  protected:
+  // Reads the line information straight from a PDB, through DIA.
+  // @param pdb_path the PDB whose line information is to be read.
+  // @returns true on success, false otherwise.
+  bool InitFromPdb(const base::FilePath& pdb_path);
+
   // Used to store unique file names in a manner such that we can draw stable
   // pointers to them. The SourceLine objects will point to the strings in this
   // set.
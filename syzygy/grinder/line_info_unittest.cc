@@ -14,6 +14,8 @@
 
 #include "syzygy/grinder/line_info.h"
 
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
 #include "base/win/scoped_com_initializer.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -79,6 +81,20 @@ void PushBackSourceLine(TestLineInfo* line_info,
       size));
 }
 
+void ExpectSameLineInfo(const LineInfo& expected, const LineInfo& actual) {
+  EXPECT_THAT(actual.source_files(),
+              ::testing::ContainerEq(expected.source_files()));
+  ASSERT_EQ(expected.source_lines().size(), actual.source_lines().size());
+  for (size_t i = 0; i < expected.source_lines().size(); ++i) {
+    const LineInfo::SourceLine& expected_line = expected.source_lines()[i];
+    const LineInfo::SourceLine& actual_line = actual.source_lines()[i];
+    EXPECT_EQ(*expected_line.source_file_name, *actual_line.source_file_name);
+    EXPECT_EQ(expected_line.line_number, actual_line.line_number);
+    EXPECT_EQ(expected_line.address, actual_line.address);
+    EXPECT_EQ(expected_line.size, actual_line.size);
+  }
+}
+
 #define EXPECT_LINES_VISITED(line_info, ...) \
     { \
       const size_t kLineNumbers[] = { __VA_ARGS__ }; \
@@ -117,6 +133,44 @@ TEST_F(LineInfoTest, InitStaticPdb) {
   EXPECT_EQ(8379u, line_info.source_lines().size());
 }
 
+TEST_F(LineInfoTest, EncodeAndDecode) {
+  TestLineInfo line_info;
+  ASSERT_TRUE(line_info.Init(static_pdb_path_, base::FilePath()));
+
+  std::vector<uint8_t> data;
+  line_info.Encode(&data);
+  ASSERT_FALSE(data.empty());
+
+  TestLineInfo decoded_line_info;
+  ASSERT_TRUE(decoded_line_info.Decode(data.data(), data.size()));
+  ExpectSameLineInfo(line_info, decoded_line_info);
+
+  // Truncated data is rejected.
+  EXPECT_FALSE(decoded_line_info.Decode(data.data(), data.size() - 1));
+  EXPECT_TRUE(decoded_line_info.source_files().empty());
+  EXPECT_TRUE(decoded_line_info.source_lines().empty());
+}
+
+TEST_F(LineInfoTest, InitThroughCache) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath cache_dir = temp_dir.path().Append(L"cache");
+
+  TestLineInfo line_info;
+  ASSERT_TRUE(line_info.Init(static_pdb_path_, base::FilePath()));
+
+  // The first read populates the cache.
+  TestLineInfo cached_line_info;
+  ASSERT_TRUE(cached_line_info.Init(static_pdb_path_, cache_dir));
+  ExpectSameLineInfo(line_info, cached_line_info);
+  EXPECT_FALSE(base::IsDirectoryEmpty(cache_dir));
+
+  // The second is served from it.
+  TestLineInfo reread_line_info;
+  ASSERT_TRUE(reread_line_info.Init(static_pdb_path_, cache_dir));
+  ExpectSameLineInfo(line_info, reread_line_info);
+}
+
 TEST_F(LineInfoTest, Visit) {
   TestLineInfo line_info;
 
@@ -211,4 +265,30 @@ TEST_F(LineInfoTest, VisitCounterWorks) {
   EXPECT_EQ(0xffffffff, line_it->visit_count);
 }
 
+TEST_F(LineInfoTest, AddVisits) {
+  std::string source_file("foo.cc");
+  TestLineInfo line_info;
+  PushBackSourceLine(&line_info, &source_file, 1, 4096, 2);
+  PushBackSourceLine(&line_info, &source_file, 2, 4098, 2);
+  TestLineInfo other;
+  PushBackSourceLine(&other, &source_file, 1, 4096, 2);
+  PushBackSourceLine(&other, &source_file, 2, 4098, 2);
+
+  EXPECT_TRUE(line_info.Visit(core::RelativeAddress(4096), 2, 1));
+  EXPECT_TRUE(other.Visit(core::RelativeAddress(4096), 4, 2));
+  EXPECT_TRUE(line_info.AddVisits(other));
+  EXPECT_EQ(3u, line_info.source_lines()[0].visit_count);
+  EXPECT_EQ(2u, line_info.source_lines()[1].visit_count);
+
+  // The visit counts saturate.
+  EXPECT_TRUE(other.Visit(core::RelativeAddress(4096), 2, 0xffffffff));
+  EXPECT_TRUE(line_info.AddVisits(other));
+  EXPECT_EQ(0xffffffff, line_info.source_lines()[0].visit_count);
+
+  // Line information that doesn't match is rejected.
+  PushBackSourceLine(&other, &source_file, 3, 4100, 2);
+  EXPECT_FALSE(line_info.AddVisits(other));
+  EXPECT_EQ(4u, line_info.source_lines()[1].visit_count);
+}
+
 }  // namespace grinder
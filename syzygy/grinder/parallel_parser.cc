@@ -0,0 +1,205 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/grinder/parallel_parser.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "base/logging.h"
+#include "base/files/file_util.h"
+#include "base/threading/simple_thread.h"
+#include "base/win/scoped_com_initializer.h"
+
+namespace grinder {
+
+// Parses a share of the trace files with a worker grinder, on a thread of its
+// own.
+class ParallelParser::Worker : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param grinder the worker grinder to which the events are fed.
+  // @param trace_files the trace files to parse.
+  Worker(std::unique_ptr<GrinderInterface> grinder,
+         const std::vector<base::FilePath>& trace_files)
+      : grinder_(std::move(grinder)),
+        trace_files_(trace_files),
+        succeeded_(false) {
+    DCHECK(grinder_.get() != NULL);
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override;
+  // @}
+
+  // @name Accessors.
+  // @{
+  GrinderInterface* grinder() const { return grinder_.get(); }
+  bool succeeded() const { return succeeded_; }
+  // @}
+
+ private:
+  std::unique_ptr<GrinderInterface> grinder_;
+  std::vector<base::FilePath> trace_files_;
+  trace::parser::Parser parser_;
+
+  // Set to true once all the trace files are parsed.
+  bool succeeded_;
+
+  DISALLOW_COPY_AND_ASSIGN(Worker);
+};
+
+void ParallelParser::Worker::Run() {
+  // The grinders read symbols through DIA as they handle events.
+  base::win::ScopedCOMInitializer com_initializer;
+
+  grinder_->SetParser(&parser_);
+  if (!parser_.Init(grinder_.get()))
+    return;
+
+  for (size_t i = 0; i < trace_files_.size(); ++i) {
+    if (!parser_.OpenTraceFile(trace_files_[i])) {
+      LOG(ERROR) << "Unable to open trace file \'"
+                 << trace_files_[i].value() << "'";
+      return;
+    }
+  }
+
+  if (!parser_.Consume())
+    return;
+
+  succeeded_ = true;
+}
+
+ParallelParser::ParallelParser(GrinderInterface* grinder, size_t num_threads)
+    : grinder_(grinder), num_threads_(num_threads) {
+  DCHECK(grinder != NULL);
+  DCHECK_LT(0u, num_threads);
+}
+
+ParallelParser::~ParallelParser() {
+}
+
+bool ParallelParser::Consume(const std::vector<base::FilePath>& trace_files) {
+  DCHECK(!trace_files.empty());
+
+  size_t num_workers = std::min(num_threads_, trace_files.size());
+  if (num_workers <= 1)
+    return ConsumeSequentially(trace_files);
+
+  std::vector<std::vector<base::FilePath>> assignments;
+  if (!AssignTraceFiles(trace_files, num_workers, &assignments))
+    return false;
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (size_t i = 0; i < assignments.size(); ++i) {
+    if (assignments[i].empty())
+      continue;
+
+    std::unique_ptr<GrinderInterface> grinder(grinder_->CreateWorker());
+    if (grinder.get() == NULL) {
+      LOG(INFO) << "The grinder doesn't support parsing in parallel.";
+      return ConsumeSequentially(trace_files);
+    }
+    workers.push_back(std::unique_ptr<Worker>(
+        new Worker(std::move(grinder), assignments[i])));
+  }
+
+  LOG(INFO) << "Parsing on " << workers.size() << " threads.";
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(workers[i].get(), "ParallelParser")));
+    threads.back()->Start();
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i]->Join();
+
+  // The workers are merged in order, and released as they're merged.
+  bool success = true;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    if (!workers[i]->succeeded()) {
+      success = false;
+    } else if (success && !grinder_->MergeWorker(workers[i]->grinder())) {
+      LOG(ERROR) << "Failed to merge the data of a parse thread.";
+      success = false;
+    }
+    workers[i].reset();
+  }
+
+  return success;
+}
+
+bool ParallelParser::AssignTraceFiles(
+    const std::vector<base::FilePath>& trace_files,
+    size_t num_workers,
+    std::vector<std::vector<base::FilePath>>* assignments) {
+  DCHECK_LT(0u, num_workers);
+  DCHECK(assignments != NULL);
+
+  // Sort the trace files by decreasing size, stably so that files of the same
+  // size are assigned in order.
+  typedef std::pair<int64_t, size_t> FileSize;
+  std::vector<FileSize> file_sizes;
+  for (size_t i = 0; i < trace_files.size(); ++i) {
+    int64_t size = 0;
+    if (!base::GetFileSize(trace_files[i], &size)) {
+      LOG(ERROR) << "Unable to get the size of trace file \'"
+                 << trace_files[i].value() << "'";
+      return false;
+    }
+    file_sizes.push_back(std::make_pair(size, i));
+  }
+  std::stable_sort(file_sizes.begin(), file_sizes.end(),
+                   [](const FileSize& a, const FileSize& b) {
+                     return a.first > b.first;
+                   });
+
+  // Assign each to the worker with the fewest bytes so far.
+  std::vector<int64_t> worker_sizes(num_workers, 0);
+  std::vector<size_t> file_workers(trace_files.size(), 0);
+  for (size_t i = 0; i < file_sizes.size(); ++i) {
+    size_t worker = std::min_element(worker_sizes.begin(),
+                                     worker_sizes.end()) -
+                    worker_sizes.begin();
+    worker_sizes[worker] += file_sizes[i].first;
+    file_workers[file_sizes[i].second] = worker;
+  }
+
+  assignments->clear();
+  assignments->resize(num_workers);
+  for (size_t i = 0; i < trace_files.size(); ++i)
+    (*assignments)[file_workers[i]].push_back(trace_files[i]);
+
+  return true;
+}
+
+bool ParallelParser::ConsumeSequentially(
+    const std::vector<base::FilePath>& trace_files) {
+  grinder_->SetParser(&parser_);
+  if (!parser_.Init(grinder_))
+    return false;
+
+  for (size_t i = 0; i < trace_files.size(); ++i) {
+    if (!parser_.OpenTraceFile(trace_files[i])) {
+      LOG(ERROR) << "Unable to open trace file \'"
+                 << trace_files[i].value() << "'";
+      return false;
+    }
+  }
+
+  return parser_.Consume();
+}
+
+}  // namespace grinder
@@ -0,0 +1,83 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the ParallelParser, which feeds the events of a set of trace files
+// to a grinder, parsing them on several threads if the grinder supports it.
+//
+// Each thread has a worker grinder and a parser of its own, and parses a share
+// of the trace files. The trace files are independent of one another, but the
+// events of a given trace file are parsed in order, by a single worker. Once
+// all the trace files are parsed, the workers are merged back into the grinder.
+#ifndef SYZYGY_GRINDER_PARALLEL_PARSER_H_
+#define SYZYGY_GRINDER_PARALLEL_PARSER_H_
+
+#include <memory>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "syzygy/grinder/grinder.h"
+#include "syzygy/trace/parse/parser.h"
+
+namespace grinder {
+
+class ParallelParser {
+ public:
+  // @param grinder the grinder to which the events are fed.
+  // @param num_threads the maximum number of threads on which to parse. If
+  //     this is one, or the grinder doesn't support parsing in parallel, the
+  //     trace files are parsed in turn on the calling thread.
+  ParallelParser(GrinderInterface* grinder, size_t num_threads);
+  ~ParallelParser();
+
+  // Parses the given trace files, and feeds their events to the grinder.
+  // @param trace_files the trace files to parse.
+  // @returns true on success, false otherwise.
+  bool Consume(const std::vector<base::FilePath>& trace_files);
+
+ protected:
+  class Worker;
+
+  // Shares trace files out between workers, so that each parses about the
+  // same number of bytes. The largest files are assigned first, each to the
+  // worker with the fewest bytes assigned so far.
+  // @param trace_files the trace files to share out.
+  // @param num_workers the number of workers.
+  // @param assignments receives the trace files of each worker, in the order
+  //     of @p trace_files. Workers may be assigned no trace files.
+  // @returns true on success, false if the size of a file can't be read.
+  static bool AssignTraceFiles(
+      const std::vector<base::FilePath>& trace_files,
+      size_t num_workers,
+      std::vector<std::vector<base::FilePath>>* assignments);
+
+  // Parses the trace files in turn with a single parser.
+  bool ConsumeSequentially(const std::vector<base::FilePath>& trace_files);
+
+  // The grinder to which the events are fed.
+  GrinderInterface* grinder_;
+
+  // The maximum number of threads on which to parse.
+  size_t num_threads_;
+
+  // The parser used when parsing sequentially. This outlives the parse, as
+  // the grinder keeps a pointer to it.
+  trace::parser::Parser parser_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ParallelParser);
+};
+
+}  // namespace grinder
+
+#endif  // SYZYGY_GRINDER_PARALLEL_PARSER_H_
@@ -0,0 +1,170 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/grinder/parallel_parser.h"
+
+#include <string>
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/strings/stringprintf.h"
+#include "base/win/scoped_com_initializer.h"
+#include "gtest/gtest.h"
+#include "syzygy/pe/unittest_util.h"
+
+namespace grinder {
+
+namespace {
+
+class TestParallelParser : public ParallelParser {
+ public:
+  using ParallelParser::AssignTraceFiles;
+};
+
+// A grinder that counts the processes it sees.
+class CountingGrinder : public GrinderInterface {
+ public:
+  explicit CountingGrinder(bool supports_workers)
+      : supports_workers_(supports_workers), num_processes_(0) {
+  }
+
+  // @name GrinderInterface implementation.
+  // @{
+  bool ParseCommandLine(const base::CommandLine* command_line) override {
+    return true;
+  }
+  void SetParser(Parser* parser) override {}
+  std::unique_ptr<GrinderInterface> CreateWorker() override {
+    if (!supports_workers_)
+      return nullptr;
+    return std::unique_ptr<GrinderInterface>(new CountingGrinder(true));
+  }
+  bool MergeWorker(GrinderInterface* worker) override {
+    num_processes_ += static_cast<CountingGrinder*>(worker)->num_processes_;
+    return true;
+  }
+  bool Grind() override { return true; }
+  bool OutputData(FILE* file) override { return true; }
+  // @}
+
+  // @name ParseEventHandler overrides.
+  // @{
+  void OnProcessStarted(base::Time time,
+                        DWORD process_id,
+                        const TraceSystemInfo* data) override {
+    ++num_processes_;
+  }
+  // @}
+
+  size_t num_processes() const { return num_processes_; }
+
+ private:
+  bool supports_workers_;
+  size_t num_processes_;
+};
+
+class ParallelParserTest : public testing::PELibUnitTest {
+ public:
+  virtual void SetUp() override {
+    testing::PELibUnitTest::SetUp();
+    for (size_t i = 0; i < arraysize(testing::kCoverageTraceFiles); ++i) {
+      trace_files_.push_back(testing::GetExeTestDataRelativePath(
+          testing::kCoverageTraceFiles[i]));
+    }
+  }
+
+  // Ensures that COM is initialized for tests in this fixture.
+  base::win::ScopedCOMInitializer com_initializer_;
+
+  std::vector<base::FilePath> trace_files_;
+};
+
+}  // namespace
+
+TEST_F(ParallelParserTest, AssignTraceFiles) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+
+  const size_t kSizes[] = { 10, 50, 20, 30, 40 };
+  std::vector<base::FilePath> files;
+  for (size_t i = 0; i < arraysize(kSizes); ++i) {
+    base::FilePath path = temp_dir.path().Append(
+        base::StringPrintf(L"file-%d.bin", static_cast<int>(i)));
+    std::string contents(kSizes[i], 'x');
+    ASSERT_EQ(static_cast<int>(contents.size()),
+              base::WriteFile(path, contents.data(), contents.size()));
+    files.push_back(path);
+  }
+
+  // The 50, 20 and 10 byte files go to the first worker, and the 40 and 30
+  // byte files to the second, each in the order given.
+  std::vector<std::vector<base::FilePath>> assignments;
+  ASSERT_TRUE(TestParallelParser::AssignTraceFiles(files, 2, &assignments));
+  ASSERT_EQ(2u, assignments.size());
+  ASSERT_EQ(3u, assignments[0].size());
+  EXPECT_EQ(files[0], assignments[0][0]);
+  EXPECT_EQ(files[1], assignments[0][1]);
+  EXPECT_EQ(files[2], assignments[0][2]);
+  ASSERT_EQ(2u, assignments[1].size());
+  EXPECT_EQ(files[3], assignments[1][0]);
+  EXPECT_EQ(files[4], assignments[1][1]);
+
+  // Surplus workers are assigned nothing.
+  ASSERT_TRUE(TestParallelParser::AssignTraceFiles(files, 8, &assignments));
+  ASSERT_EQ(8u, assignments.size());
+  size_t num_assigned = 0;
+  for (size_t i = 0; i < assignments.size(); ++i) {
+    EXPECT_GE(1u, assignments[i].size());
+    num_assigned += assignments[i].size();
+  }
+  EXPECT_EQ(files.size(), num_assigned);
+
+  // Files that don't exist are rejected.
+  files.push_back(temp_dir.path().Append(L"missing.bin"));
+  EXPECT_FALSE(TestParallelParser::AssignTraceFiles(files, 2, &assignments));
+}
+
+TEST_F(ParallelParserTest, ConsumeInParallel) {
+  CountingGrinder expected(true);
+  ParallelParser sequential_parser(&expected, 1);
+  ASSERT_TRUE(sequential_parser.Consume(trace_files_));
+  EXPECT_LT(0u, expected.num_processes());
+
+  CountingGrinder grinder(true);
+  ParallelParser parser(&grinder, 3);
+  ASSERT_TRUE(parser.Consume(trace_files_));
+  EXPECT_EQ(expected.num_processes(), grinder.num_processes());
+}
+
+TEST_F(ParallelParserTest, ConsumeFallsBackToSequentialParsing) {
+  CountingGrinder expected(true);
+  ParallelParser sequential_parser(&expected, 1);
+  ASSERT_TRUE(sequential_parser.Consume(trace_files_));
+
+  CountingGrinder grinder(false);
+  ParallelParser parser(&grinder, 3);
+  ASSERT_TRUE(parser.Consume(trace_files_));
+  EXPECT_EQ(expected.num_processes(), grinder.num_processes());
+}
+
+TEST_F(ParallelParserTest, ConsumeFailsOnMissingFile) {
+  trace_files_.push_back(
+      testing::GetExeTestDataRelativePath(L"coverage_traces\\missing.bin"));
+
+  CountingGrinder grinder(true);
+  ParallelParser parser(&grinder, 2);
+  EXPECT_FALSE(parser.Consume(trace_files_));
+}
+
+}  // namespace grinder
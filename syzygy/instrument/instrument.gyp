@@ -90,6 +90,7 @@
             'block_graph_transforms_lib',
         '<(src)/syzygy/ar/ar.gyp:ar_lib',
         '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/grinder/grinder.gyp:grinder_lib',
         '<(src)/syzygy/pe/orderers/pe_orderers.gyp:pe_orderers_lib',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/pe/transforms/pe_transforms.gyp:pe_transforms_lib',
@@ -20,9 +20,18 @@
 #include <algorithm>
 #include <iostream>
 #include <string>
+#include <utility>
 
+#include "base/atomicops.h"
+#include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
+#include "base/strings/utf_string_conversions.h"
+#include "base/sys_info.h"
+#include "base/threading/simple_thread.h"
+#include "base/win/scoped_com_initializer.h"
 #include "syzygy/instrument/instrumenters/afl_instrumenter.h"
 #include "syzygy/instrument/instrumenters/archive_instrumenter.h"
 #include "syzygy/instrument/instrumenters/asan_instrumenter.h"
@@ -58,17 +67,41 @@ static const char kUsageFormatStr[] =
     "    --call-trace-client=<path>\n"
     "                            Equivalent to --mode=calltrace\n"
     "                                 --agent=<path>.\n"
+    "  Batch options:\n"
+    "    --batch=<path>          Instrument all of the images listed in a\n"
+    "                            manifest, in a single process, instead of\n"
+    "                            the one given by --input-image. Each line of\n"
+    "                            the manifest holds the switches of one\n"
+    "                            image, and inherits the other switches of\n"
+    "                            the command line. Empty lines and lines\n"
+    "                            starting with '#' are ignored. The time\n"
+    "                            each image took is reported once done.\n"
+    "    --jobs=<n>              The maximum number of images to instrument\n"
+    "                            concurrently. Defaults to the number of\n"
+    "                            processors.\n"
     "  General options (applicable in all modes):\n"
     "    --agent=<path>          If specified indicates exactly which DLL to\n"
     "                            use when instrumenting the provided module.\n"
     "                            If not specified a default agent library\n"
     "                            will be used. This is ignored in Asan mode.\n"
+    "    --arena-storage         Allocate the references, referrers and labels\n"
+    "                            of the decomposed image from an arena. This\n"
+    "                            lowers the memory footprint of large images.\n"
     "    --debug-friendly        Generate more debugger friendly output by\n"
     "                            making the thunks resolve to the original\n"
     "                            function's name. This is at the cost of the\n"
     "                            uniqueness of address->name resolution.\n"
+    "    --decomposition-threads=<n>\n"
+    "                            Decompose the code blocks to basic blocks on\n"
+    "                            <n> worker threads. This applies to the asan\n"
+    "                            and bbentry modes. Also resolves the\n"
+    "                            relocations of COFF inputs on <n> threads.\n"
+    "                            Defaults to 0, which decomposes them\n"
+    "                            serially.\n"
     "    --inline-fast-path      Inline a fast path into the instrumented\n"
-    "                            image.\n"
+    "                            image. In bbentry mode, this counts the\n"
+    "                            basic-block entries in per-thread counters\n"
+    "                            without calling into the agent.\n"
     "    --input-pdb=<path>      The PDB for the DLL to instrument. If not\n"
     "                            explicitly provided will be searched for.\n"
     "    --filter=<path>         The path of the filter to be used in\n"
@@ -84,14 +117,28 @@ static const char kUsageFormatStr[] =
     "    --output-pdb=<path>     The PDB for the instrumented DLL. If not\n"
     "                            provided will attempt to generate one.\n"
     "    --overwrite             Allow output files to be overwritten.\n"
+    "    --pdb-reader-threads=<n>\n"
+    "                            Decompose PE images by reading their PDB\n"
+    "                            directly, parsing the symbols of its modules\n"
+    "                            on <n> worker threads. Defaults to 0, which\n"
+    "                            reads the PDB via DIA.\n"
+    "    --phase-profile=<path>  Write the time and memory taken by each\n"
+    "                            phase of the relink to a JSON file.\n"
     "  afl options:\n"
     "    --config=<path>         Specifies a JSON file describing, either\n"
     "                            a whitelist of functions to instrument or\n"
     "                            a blacklist of functions to not instrument.\n"
     "    --cookie-check-hook     Hooks __security_cookie_check.\n"
+    "    --edge-indexing         Gives each basic block and conditional edge\n"
+    "                            a counter of its own, rather than hashing\n"
+    "                            edges into a 64KiB bitmap. The bitmap is\n"
+    "                            grown to fit the counters.\n"
     "    --force-decompose       Forces block decomposition.\n"
     "    --multithread           Uses a thread-safe instrumentation.\n"
     "  asan mode options:\n"
+    "    --archive-jobs=<n>      The maximum number of object files of a .lib\n"
+    "                            to instrument concurrently. Defaults to the\n"
+    "                            number of processors.\n"
     "    --asan-rtl-options=OPTIONS\n"
     "                            Allows specification of options that will\n"
     "                            influence the Asan RTL that attaches to the\n"
@@ -99,7 +146,21 @@ static const char kUsageFormatStr[] =
     "                            these options see common/asan_parameters. If\n"
     "                            not specified then the defaults of the RTL\n"
     "                            will be used.\n"
+    "    --check-budget=NUM      The number of checks the instrumented\n"
+    "                            module may execute during the run captured\n"
+    "                            by --instrumentation-profile. The hottest\n"
+    "                            basic blocks are sampled or left\n"
+    "                            uninstrumented to honour it.\n"
+    "    --coalesce-checks       Checks runs of accesses to adjacent memory\n"
+    "                            with a single range check. Requires a\n"
+    "                            runtime exporting the range checks.\n"
+    "    --hoist-loop-checks     Hoists the checks of the accesses that are\n"
+    "                            invariant in a loop out of the loop.\n"
     "    --hot-patching          Use hot patching Asan instrumentation.\n"
+    "    --instrumentation-profile=<path>\n"
+    "                            A basic block entry or branch profile of the\n"
+    "                            module, as output by the grinder. Requires\n"
+    "                            --check-budget.\n"
     "    --instrumentation-rate=DOUBLE\n"
     "                            Specifies the fraction of instructions to\n"
     "                            be instrumented, as a value in the range\n"
@@ -111,11 +172,22 @@ static const char kUsageFormatStr[] =
     "                            analysis.\n"
     "    --no-redundancy-analysis\n"
     "                            Disables redundant memory access analysis.\n"
+    "    --transform-cache=<path>\n"
+    "                            A file caching the instrumented code blocks\n"
+    "                            across runs. The blocks that are unchanged\n"
+    "                            since the previous run are copied from it\n"
+    "                            rather than instrumented again. Each image\n"
+    "                            needs a cache of its own. Not used with\n"
+    "                            --filter, --hot-patching, an instrumentation\n"
+    "                            profile or an instrumentation rate below 1.\n"
     "  branch mode options:\n"
     "    --buffering             Enable per-thread buffering of events.\n"
     "    --fs-slot=<slot>        Specify which FS slot to use for thread\n"
     "                            local storage.\n"
     "  calltrace mode options:\n"
+    "    --compact-thunks        Hook the functions through a table of small\n"
+    "                            stubs sharing a single trampoline, rather\n"
+    "                            than through a thunk per function.\n"
     "    --instrument-imports    Also instrument calls to imports.\n"
     "    --module-entry-only     If specified then the per-function entry\n"
     "                            hook will not be used and only module entry\n"
@@ -123,10 +195,23 @@ static const char kUsageFormatStr[] =
     "    --no-unsafe-refs        Perform no instrumentation of references\n"
     "                            between code blocks that contain anything\n"
     "                            but C/C++.\n"
+    "  coverage mode options:\n"
+    "    --inline-bitmap         Mark the basic blocks as visited directly in\n"
+    "                            the coverage bitmap of the image, which the\n"
+    "                            agent only reads when the module unloads.\n"
+    "                            This needs no scratch register.\n"
     "  profile mode options:\n"
+    "    --compact-thunks        Hook the functions through a table of small\n"
+    "                            stubs sharing a single trampoline, rather\n"
+    "                            than through a thunk per function.\n"
     "    --instrument-imports    Also instrument calls to imports.\n"
     "\n";
 
+// The switches that only apply to the batch itself, and that the images of the
+// batch don't inherit.
+const char kBatchSwitch[] = "batch";
+const char kJobsSwitch[] = "jobs";
+
 // Currently only Asan supports COFF/LIB instrumentation. As other
 // instrumenters add COFF support they need to be added with a similar
 // mechanism.
@@ -136,83 +221,242 @@ InstrumenterInterface* AsanInstrumenterFactory() {
 
 }  // namespace
 
-void InstrumentApp::ParseDeprecatedMode(const base::CommandLine* cmd_line) {
+// The work shared by the threads instrumenting the images of a batch. Each
+// run instruments the next image that no thread has claimed yet.
+class InstrumentApp::BatchWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit BatchWork(BatchEntries* batch) : batch_(batch), next_index_(0) {
+    DCHECK(batch != NULL);
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, batch_->size());
+    BatchEntry* entry = (*batch_)[index].get();
+
+    // The worker threads need COM for DIA.
+    base::win::ScopedCOMInitializer com_initializer;
+    base::Time start = base::Time::Now();
+    entry->succeeded = com_initializer.succeeded() &&
+                       entry->instrumenter->Instrument();
+    entry->elapsed = base::Time::Now() - start;
+  }
+  // @}
+
+ private:
+  BatchEntries* batch_;
+  base::subtle::Atomic32 next_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(BatchWork);
+};
+
+void InstrumentApp::ParseDeprecatedMode(
+    const base::CommandLine* cmd_line,
+    std::unique_ptr<InstrumenterInterface>* instrumenter) {
   DCHECK(cmd_line != NULL);
+  DCHECK(instrumenter != NULL);
 
   std::string client = cmd_line->GetSwitchValueASCII("call-trace-client");
 
   if (client.empty()) {
     LOG(INFO) << "DEPRECATED: No mode specified, using --mode=calltrace.";
-    instrumenter_.reset(new instrumenters::EntryThunkInstrumenter(
+    instrumenter->reset(new instrumenters::EntryThunkInstrumenter(
         instrumenters::EntryThunkInstrumenter::CALL_TRACE));
     return;
   }
 
   if (base::LowerCaseEqualsASCII(client, "profiler")) {
     LOG(INFO) << "DEPRECATED: Using --mode=profile.";
-    instrumenter_.reset(new instrumenters::EntryThunkInstrumenter(
+    instrumenter->reset(new instrumenters::EntryThunkInstrumenter(
         instrumenters::EntryThunkInstrumenter::PROFILE));
   } else if (base::LowerCaseEqualsASCII(client, "rpc")) {
     LOG(INFO) << "DEPRECATED: Using --mode=calltrace.";
-    instrumenter_.reset(new instrumenters::EntryThunkInstrumenter(
+    instrumenter->reset(new instrumenters::EntryThunkInstrumenter(
         instrumenters::EntryThunkInstrumenter::CALL_TRACE));
   } else {
     LOG(INFO) << "DEPRECATED: Using --mode=calltrace --agent=" << client << ".";
-    instrumenter_.reset(new instrumenters::EntryThunkInstrumenter(
+    instrumenter->reset(new instrumenters::EntryThunkInstrumenter(
         instrumenters::EntryThunkInstrumenter::CALL_TRACE));
   }
 }
 
-bool InstrumentApp::ParseCommandLine(const base::CommandLine* cmd_line) {
+bool InstrumentApp::CreateInstrumenter(
+    const base::CommandLine* cmd_line,
+    std::unique_ptr<InstrumenterInterface>* instrumenter) {
   DCHECK(cmd_line != NULL);
-
-  if (cmd_line->HasSwitch("help"))
-    return Usage(cmd_line, "");
+  DCHECK(instrumenter != NULL);
 
   // Get the mode and the default client DLL.
   if (!cmd_line->HasSwitch("mode")) {
     // TODO(chrisha): Remove this once build scripts and profiling tools have
     //     been updated.
-    ParseDeprecatedMode(cmd_line);
+    ParseDeprecatedMode(cmd_line, instrumenter);
+    return true;
+  }
+
+  std::string mode = cmd_line->GetSwitchValueASCII("mode");
+  if (base::LowerCaseEqualsASCII(mode, "afl")) {
+    instrumenter->reset(new instrumenters::AFLInstrumenter());
+  } else if (base::LowerCaseEqualsASCII(mode, "asan")) {
+    // We wrap the Asan instrumenter in an ArchiveInstrumenter adapter so
+    // that it can transparently handle .lib files.
+    instrumenter->reset(new instrumenters::ArchiveInstrumenter(
+        &AsanInstrumenterFactory));
+  } else if (base::LowerCaseEqualsASCII(mode, "bbentry")) {
+    instrumenter->reset(new instrumenters::BasicBlockEntryInstrumenter());
+  } else if (base::LowerCaseEqualsASCII(mode, "branch")) {
+    instrumenter->reset(new instrumenters::BranchInstrumenter());
+  } else if (base::LowerCaseEqualsASCII(mode, "calltrace")) {
+    instrumenter->reset(new instrumenters::EntryThunkInstrumenter(
+        instrumenters::EntryThunkInstrumenter::CALL_TRACE));
+  } else if (base::LowerCaseEqualsASCII(mode, "coverage")) {
+    instrumenter->reset(new instrumenters::CoverageInstrumenter());
+  } else if (base::LowerCaseEqualsASCII(mode, "flummox")) {
+    instrumenter->reset(new instrumenters::FlummoxInstrumenter());
+  } else if (base::LowerCaseEqualsASCII(mode, "profile")) {
+    instrumenter->reset(new instrumenters::EntryCallInstrumenter());
   } else {
+    return false;
+  }
+
+  return true;
+}
+
+bool InstrumentApp::ParseCommandLine(const base::CommandLine* cmd_line) {
+  DCHECK(cmd_line != NULL);
+
+  if (cmd_line->HasSwitch("help"))
+    return Usage(cmd_line, "");
+
+  if (cmd_line->HasSwitch(kBatchSwitch))
+    return ParseBatch(cmd_line);
+
+  if (!CreateInstrumenter(cmd_line, &instrumenter_)) {
     std::string mode = cmd_line->GetSwitchValueASCII("mode");
-    if (base::LowerCaseEqualsASCII(mode, "afl")) {
-      instrumenter_.reset(new instrumenters::AFLInstrumenter());
-    } else if (base::LowerCaseEqualsASCII(mode, "asan")) {
-      // We wrap the Asan instrumenter in an ArchiveInstrumenter adapter so
-      // that it can transparently handle .lib files.
-      instrumenter_.reset(new instrumenters::ArchiveInstrumenter(
-          &AsanInstrumenterFactory));
-    } else if (base::LowerCaseEqualsASCII(mode, "bbentry")) {
-      instrumenter_.reset(new instrumenters::BasicBlockEntryInstrumenter());
-    } else if (base::LowerCaseEqualsASCII(mode, "branch")) {
-      instrumenter_.reset(new instrumenters::BranchInstrumenter());
-    } else if (base::LowerCaseEqualsASCII(mode, "calltrace")) {
-      instrumenter_.reset(new instrumenters::EntryThunkInstrumenter(
-          instrumenters::EntryThunkInstrumenter::CALL_TRACE));
-    } else if (base::LowerCaseEqualsASCII(mode, "coverage")) {
-      instrumenter_.reset(new instrumenters::CoverageInstrumenter());
-    } else if (base::LowerCaseEqualsASCII(mode, "flummox")) {
-      instrumenter_.reset(new instrumenters::FlummoxInstrumenter());
-    } else if (base::LowerCaseEqualsASCII(mode, "profile")) {
-      instrumenter_.reset(new instrumenters::EntryCallInstrumenter());
-    } else {
-      return Usage(cmd_line,
-                   base::StringPrintf("Unknown instrumentation mode: %s.",
-                                      mode.c_str()).c_str());
-    }
+    return Usage(cmd_line,
+                 base::StringPrintf("Unknown instrumentation mode: %s.",
+                                    mode.c_str()).c_str());
   }
   DCHECK(instrumenter_.get() != NULL);
 
   return instrumenter_->ParseCommandLine(cmd_line);
 }
 
+bool InstrumentApp::ParseBatch(const base::CommandLine* cmd_line) {
+  DCHECK(cmd_line != NULL);
+
+  batch_path_ = AbsolutePath(cmd_line->GetSwitchValuePath(kBatchSwitch));
+  if (batch_path_.empty())
+    return Usage(cmd_line, "The batch manifest must be specified.");
+
+  jobs_ = base::SysInfo::NumberOfProcessors();
+  if (cmd_line->HasSwitch(kJobsSwitch)) {
+    std::string jobs = cmd_line->GetSwitchValueASCII(kJobsSwitch);
+    unsigned value = 0;
+    if (!base::StringToUint(jobs, &value) || value == 0)
+      return Usage(cmd_line, "The number of jobs must be a positive integer.");
+    jobs_ = value;
+  }
+
+  std::string manifest;
+  if (!base::ReadFileToString(batch_path_, &manifest)) {
+    LOG(ERROR) << "Failed to read batch manifest: " << batch_path_.value();
+    return false;
+  }
+
+  // Each line of the manifest holds the switches of one image. Empty lines
+  // and lines starting with '#' are ignored.
+  std::vector<std::string> lines = base::SplitString(
+      manifest, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (lines[i].empty() || lines[i][0] == '#')
+      continue;
+
+    base::CommandLine entry_cmd_line = base::CommandLine::FromString(
+        L"\"" + cmd_line->GetProgram().value() + L"\" " +
+        base::UTF8ToWide(lines[i]));
+
+    // Inherit the switches of the batch that the image doesn't override.
+    for (const auto& batch_switch : cmd_line->GetSwitches()) {
+      if (batch_switch.first == kBatchSwitch ||
+          batch_switch.first == kJobsSwitch ||
+          entry_cmd_line.HasSwitch(batch_switch.first)) {
+        continue;
+      }
+      entry_cmd_line.AppendSwitchNative(batch_switch.first,
+                                        batch_switch.second);
+    }
+
+    std::unique_ptr<BatchEntry> entry(new BatchEntry(entry_cmd_line));
+    if (!CreateInstrumenter(&entry->command_line, &entry->instrumenter)) {
+      LOG(ERROR) << "Unknown instrumentation mode on line " << i + 1
+                 << " of " << batch_path_.value() << ".";
+      return false;
+    }
+    if (!entry->instrumenter->ParseCommandLine(&entry->command_line)) {
+      LOG(ERROR) << "Invalid command line on line " << i + 1 << " of "
+                 << batch_path_.value() << ".";
+      return false;
+    }
+    batch_.push_back(std::move(entry));
+  }
+
+  if (batch_.empty()) {
+    LOG(ERROR) << "The batch manifest lists no images: "
+               << batch_path_.value();
+    return false;
+  }
+
+  return true;
+}
+
 int InstrumentApp::Run() {
+  if (!batch_.empty())
+    return RunBatch() ? 0 : 1;
+
   DCHECK(instrumenter_.get() != NULL);
 
   return instrumenter_->Instrument() ? 0 : 1;
 }
 
+bool InstrumentApp::RunBatch() {
+  DCHECK(!batch_.empty());
+  DCHECK_LT(0U, jobs_);
+
+  base::Time start = base::Time::Now();
+  BatchWork work(&batch_);
+  int thread_count = static_cast<int>(std::min(jobs_, batch_.size()));
+  base::DelegateSimpleThreadPool pool("Instrumenter", thread_count);
+  pool.Start();
+  pool.AddWork(&work, static_cast<int>(batch_.size()));
+  pool.JoinAll();
+  base::TimeDelta elapsed = base::Time::Now() - start;
+
+  // Report the time each image took, in the order of the manifest.
+  size_t failures = 0;
+  base::TimeDelta total;
+  for (const auto& entry : batch_) {
+    if (!entry->succeeded)
+      ++failures;
+    total += entry->elapsed;
+    ::fprintf(out(), "%-6s %9.3f s  %ls\n",
+              entry->succeeded ? "OK" : "FAILED",
+              entry->elapsed.InSecondsF(),
+              entry->command_line.GetSwitchValuePath("input-image").value()
+                  .c_str());
+  }
+  ::fprintf(out(), "Instrumented %u of %u images with %d jobs in %.3f s "
+            "(%.3f s total).\n",
+            static_cast<unsigned>(batch_.size() - failures),
+            static_cast<unsigned>(batch_.size()), thread_count,
+            elapsed.InSecondsF(), total.InSecondsF());
+
+  return failures == 0;
+}
+
 bool InstrumentApp::Usage(const base::CommandLine* cmd_line,
                           const base::StringPiece& message) const {
   if (!message.empty()) {
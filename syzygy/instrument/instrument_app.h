@@ -18,6 +18,9 @@
 #ifndef SYZYGY_INSTRUMENT_INSTRUMENT_APP_H_
 #define SYZYGY_INSTRUMENT_INSTRUMENT_APP_H_
 
+#include <memory>
+#include <vector>
+
 #include "base/command_line.h"
 #include "base/files/file_path.h"
 #include "base/strings/string_piece.h"
@@ -34,7 +37,7 @@ namespace instrument {
 class InstrumentApp : public application::AppImplBase {
  public:
   InstrumentApp()
-      : application::AppImplBase("Instrumenter") {
+      : application::AppImplBase("Instrumenter"), jobs_(0) {
   }
 
   // @name Implementation of the AppImplBase interface.
@@ -50,13 +53,66 @@ class InstrumentApp : public application::AppImplBase {
              const base::StringPiece& message) const;
   // @}
 
+  // An image to instrument in batch mode.
+  struct BatchEntry {
+    explicit BatchEntry(const base::CommandLine& command_line)
+        : command_line(command_line), succeeded(false) {
+    }
+
+    // The command line describing the instrumentation of the image.
+    base::CommandLine command_line;
+    // The instrumenter for the image.
+    std::unique_ptr<InstrumenterInterface> instrumenter;
+    // The outcome of the instrumentation and the time it took.
+    bool succeeded;
+    base::TimeDelta elapsed;
+  };
+  typedef std::vector<std::unique_ptr<BatchEntry>> BatchEntries;
+
+  // The work of the threads instrumenting a batch.
+  class BatchWork;
+
   // Used to parse old-style deprecated command-lines.
   // TODO(chrisha): Remove this once build scripts and profiling tools have
   //     been updated.
-  void ParseDeprecatedMode(const base::CommandLine* command_line);
+  // @param command_line The command line to parse.
+  // @param instrumenter Will receive the instrumenter.
+  void ParseDeprecatedMode(
+      const base::CommandLine* command_line,
+      std::unique_ptr<InstrumenterInterface>* instrumenter);
+
+  // Creates the instrumenter for the mode specified on a command line.
+  // @param command_line The command line to parse.
+  // @param instrumenter Will receive the instrumenter.
+  // @returns true on success, false if the mode is unknown.
+  bool CreateInstrumenter(
+      const base::CommandLine* command_line,
+      std::unique_ptr<InstrumenterInterface>* instrumenter);
+
+  // Reads the manifest of a batch, and parses the command line of each of its
+  // images. The switches of @p command_line apply to all of the images,
+  // unless they are overridden in the manifest.
+  // @param command_line The command line of the batch.
+  // @returns true on success, false otherwise.
+  bool ParseBatch(const base::CommandLine* command_line);
+
+  // Instruments the images of the batch, up to jobs_ at a time, and reports
+  // the time each one took.
+  // @returns true if all of the images were instrumented successfully.
+  bool RunBatch();
 
   // The instrumenter we delegate to.
   std::unique_ptr<InstrumenterInterface> instrumenter_;
+
+  // @name Batch mode state.
+  // @{
+  // The manifest listing the images to instrument.
+  base::FilePath batch_path_;
+  // The maximum number of images to instrument concurrently.
+  size_t jobs_;
+  // The images to instrument.
+  BatchEntries batch_;
+  // @}
 };
 
 }  // namespace instrument
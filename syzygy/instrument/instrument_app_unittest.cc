@@ -15,7 +15,9 @@
 #include "syzygy/instrument/instrument_app.h"
 
 #include "base/environment.h"
+#include "base/files/file_util.h"
 #include "base/strings/stringprintf.h"
+#include "base/strings/utf_string_conversions.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/unittest_util.h"
@@ -33,7 +35,9 @@ namespace {
 
 class TestInstrumentApp : public InstrumentApp {
  public:
+  using InstrumentApp::batch_;
   using InstrumentApp::instrumenter_;
+  using InstrumentApp::jobs_;
 };
 
 typedef application::Application<TestInstrumentApp> TestApp;
@@ -81,6 +85,24 @@ class InstrumentAppTest : public testing::PELibUnitTest {
     test_app->set_err(err());
   }
 
+  // Writes a batch manifest to the temporary directory.
+  // @param contents The contents of the manifest.
+  // @returns the path of the manifest.
+  base::FilePath WriteManifest(const std::string& contents) {
+    base::FilePath path = temp_dir_.Append(L"manifest.txt");
+    EXPECT_EQ(static_cast<int>(contents.size()),
+              base::WriteFile(path, contents.data(), contents.size()));
+    return path;
+  }
+
+  // @returns a manifest line instrumenting the test DLL to @p output.
+  std::string GetManifestLine(const base::FilePath& output) {
+    return base::StringPrintf(
+        "--input-image=\"%s\" --output-image=\"%s\"\n",
+        base::WideToUTF8(input_dll_path_.value()).c_str(),
+        base::WideToUTF8(output.value()).c_str());
+  }
+
   // Stashes the current log-level before each test instance and restores it
   // after each test completes.
   testing::ScopedLogLevelSaver log_level_saver;
@@ -181,4 +203,69 @@ TEST_F(InstrumentAppTest, Run) {
   ASSERT_EQ(0, test_impl_.Run());
 }
 
+TEST_F(InstrumentAppTest, ParseBatch) {
+  base::FilePath manifest = WriteManifest(
+      "# A comment.\n" +
+      GetManifestLine(temp_dir_.Append(L"one.dll")) +
+      "\n" +
+      GetManifestLine(temp_dir_.Append(L"two.dll")));
+  cmd_line_.AppendSwitchPath("batch", manifest);
+  cmd_line_.AppendSwitchASCII("jobs", "3");
+  cmd_line_.AppendSwitchASCII("mode", "calltrace");
+  cmd_line_.AppendSwitch("overwrite");
+
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_TRUE(test_impl_.instrumenter_.get() == NULL);
+  EXPECT_EQ(3u, test_impl_.jobs_);
+  ASSERT_EQ(2u, test_impl_.batch_.size());
+  for (const auto& entry : test_impl_.batch_) {
+    EXPECT_TRUE(entry->instrumenter.get() != NULL);
+    EXPECT_EQ("calltrace", entry->command_line.GetSwitchValueASCII("mode"));
+    EXPECT_TRUE(entry->command_line.HasSwitch("overwrite"));
+    EXPECT_FALSE(entry->command_line.HasSwitch("batch"));
+    EXPECT_FALSE(entry->command_line.HasSwitch("jobs"));
+  }
+}
+
+TEST_F(InstrumentAppTest, ParseBatchFails) {
+  // The manifest doesn't exist.
+  cmd_line_.AppendSwitchPath("batch", temp_dir_.Append(L"missing.txt"));
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(InstrumentAppTest, ParseEmptyBatchFails) {
+  cmd_line_.AppendSwitchPath("batch", WriteManifest("# Nothing.\n"));
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(InstrumentAppTest, ParseBatchWithInvalidEntryFails) {
+  cmd_line_.AppendSwitchPath("batch", WriteManifest(
+      GetManifestLine(temp_dir_.Append(L"one.dll")) + "--input-image=foo\n"));
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(InstrumentAppTest, ParseBatchWithInvalidJobsFails) {
+  cmd_line_.AppendSwitchPath("batch", WriteManifest(
+      GetManifestLine(temp_dir_.Append(L"one.dll"))));
+  cmd_line_.AppendSwitchASCII("jobs", "0");
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(InstrumentAppTest, RunBatch) {
+  base::FilePath one = temp_dir_.Append(L"one.dll");
+  base::FilePath two = temp_dir_.Append(L"two.dll");
+  cmd_line_.AppendSwitchPath("batch",
+                             WriteManifest(GetManifestLine(one) +
+                                           GetManifestLine(two)));
+  cmd_line_.AppendSwitchASCII("jobs", "2");
+  cmd_line_.AppendSwitchASCII("mode", "calltrace");
+
+  ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  ASSERT_EQ(0, test_impl_.Run());
+  EXPECT_TRUE(base::PathExists(one));
+  EXPECT_TRUE(base::PathExists(two));
+  for (const auto& entry : test_impl_.batch_)
+    EXPECT_TRUE(entry->succeeded);
+}
+
 }  // namespace instrument
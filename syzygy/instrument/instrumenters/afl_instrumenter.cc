@@ -122,6 +122,12 @@ bool AFLInstrumenter::DoCommandLineParse(
     LOG(INFO) << "Thread-safe instrumentation mode enabled.";
   }
 
+  // Parse the edge indexing flag (optional).
+  edge_indexing_ = command_line->HasSwitch("edge-indexing");
+  if (edge_indexing_) {
+    LOG(INFO) << "Edge indexing mode enabled.";
+  }
+
   // Parse the cookie check hook flag (optional).
   cookie_check_hook_ = command_line->HasSwitch("cookie-check-hook");
   if (cookie_check_hook_) {
@@ -139,6 +145,7 @@ bool AFLInstrumenter::InstrumentImpl() {
   transformer_.reset(new instrument::transforms::AFLTransform(
       target_set_, whitelist_mode_, force_decomposition_, multithread_mode_,
       cookie_check_hook_));
+  transformer_->set_edge_indexing(edge_indexing_);
 
   if (!relinker_->AppendTransform(transformer_.get())) {
     LOG(ERROR) << "AppendTransform failed.";
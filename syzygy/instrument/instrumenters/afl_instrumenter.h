@@ -58,6 +58,9 @@ class AFLInstrumenter : public InstrumenterWithRelinker {
   // Cookie check hook flag.
   bool cookie_check_hook_;
 
+  // Collision-free edge indexing flag.
+  bool edge_indexing_;
+
   // The transform for this agent.
   std::unique_ptr<instrument::transforms::AFLTransform> transformer_;
 
@@ -49,6 +49,7 @@ class TestAFLInstrumenter : public AFLInstrumenter {
   using AFLInstrumenter::force_decomposition_;
   using AFLInstrumenter::multithread_mode_;
   using AFLInstrumenter::cookie_check_hook_;
+  using AFLInstrumenter::edge_indexing_;
   using AFLInstrumenter::target_set_;
   using AFLInstrumenter::whitelist_mode_;
   using InstrumenterWithRelinker::CreateRelinker;
@@ -123,6 +124,7 @@ TEST_F(AFLInstrumenterTest, ParseMinimalCli) {
   EXPECT_FALSE(instrumenter_.force_decomposition_);
   EXPECT_FALSE(instrumenter_.multithread_mode_);
   EXPECT_FALSE(instrumenter_.cookie_check_hook_);
+  EXPECT_FALSE(instrumenter_.edge_indexing_);
   EXPECT_EQ(instrumenter_.target_set_.size(), 0);
 }
 
@@ -132,6 +134,7 @@ TEST_F(AFLInstrumenterTest, ParseFullCli) {
   cmd_line_.AppendSwitch("multithread");
   cmd_line_.AppendSwitch("force-decompose");
   cmd_line_.AppendSwitch("cookie-check-hook");
+  cmd_line_.AppendSwitch("edge-indexing");
   cmd_line_.AppendSwitchPath("output-pdb", output_pdb_path_);
 
   EXPECT_TRUE(instrumenter_.ParseCommandLine(&cmd_line_));
@@ -144,6 +147,7 @@ TEST_F(AFLInstrumenterTest, ParseFullCli) {
   EXPECT_TRUE(instrumenter_.multithread_mode_);
   EXPECT_TRUE(instrumenter_.force_decomposition_);
   EXPECT_TRUE(instrumenter_.cookie_check_hook_);
+  EXPECT_TRUE(instrumenter_.edge_indexing_);
 }
 
 TEST_F(AFLInstrumenterTest, ParseWhitelist) {
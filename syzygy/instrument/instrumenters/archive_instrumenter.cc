@@ -21,6 +21,8 @@
 
 #include "base/bind.h"
 #include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/sys_info.h"
 #include "syzygy/ar/ar_transform.h"
 #include "syzygy/core/file_util.h"
 
@@ -31,15 +33,16 @@ namespace {
 
 const char kInputImage[] = "input-image";
 const char kOutputImage[] = "output-image";
+const char kArchiveJobs[] = "archive-jobs";
 
 }  // namespace
 
 ArchiveInstrumenter::ArchiveInstrumenter()
-    : factory_(NULL), overwrite_(false) {
+    : factory_(NULL), overwrite_(false), jobs_(1) {
 }
 
 ArchiveInstrumenter::ArchiveInstrumenter(InstrumenterFactoryFunction factory)
-    : factory_(factory), overwrite_(false) {
+    : factory_(factory), overwrite_(false), jobs_(1) {
   DCHECK_NE(reinterpret_cast<InstrumenterFactoryFunction>(NULL), factory);
 }
 
@@ -55,6 +58,17 @@ bool ArchiveInstrumenter::ParseCommandLine(
   output_image_ = command_line_->GetSwitchValuePath(kOutputImage);
   overwrite_ = command_line_->HasSwitch("overwrite");
 
+  jobs_ = base::SysInfo::NumberOfProcessors();
+  if (command_line_->HasSwitch(kArchiveJobs)) {
+    std::string s = command_line_->GetSwitchValueASCII(kArchiveJobs);
+    unsigned jobs = 0;
+    if (!base::StringToUint(s, &jobs) || jobs == 0) {
+      LOG(ERROR) << "Invalid number of archive jobs: " << s;
+      return false;
+    }
+    jobs_ = jobs;
+  }
+
   return true;
 }
 
@@ -122,6 +136,7 @@ bool ArchiveInstrumenter::InstrumentArchive() {
   ar_transform.set_callback(on_disk_adapter.outer_callback());
   ar_transform.set_input_archive(input_image_);
   ar_transform.set_output_archive(output_image_);
+  ar_transform.set_num_threads(jobs_);
   if (!ar_transform.Transform())
     return false;
 
@@ -19,6 +19,11 @@
 //
 // This presumes that the underlying instrumenter uses --input-image and
 // --output-image for configuring which files are operated on.
+//
+// The files of an archive are independent, so they are instrumented in
+// parallel, each by its own instance of the underlying instrumenter. The
+// --archive-jobs switch bounds the number of files instrumented at once, and
+// defaults to the number of processors.
 
 #ifndef SYZYGY_INSTRUMENT_INSTRUMENTERS_ARCHIVE_INSTRUMENTER_H_
 #define SYZYGY_INSTRUMENT_INSTRUMENTERS_ARCHIVE_INSTRUMENTER_H_
@@ -69,7 +74,7 @@ class ArchiveInstrumenter : public InstrumenterInterface {
   // Instruments an archive.
   bool InstrumentArchive();
   // Callback for the ArTransform object. This is invoked for each file in an
-  // archive.
+  // archive, possibly concurrently for different files.
   bool InstrumentFile(const base::FilePath& input_path,
                       const base::FilePath& output_path,
                       ar::ParsedArFileHeader* header,
@@ -85,6 +90,7 @@ class ArchiveInstrumenter : public InstrumenterInterface {
   base::FilePath input_image_;
   base::FilePath output_image_;
   bool overwrite_;
+  size_t jobs_;
 
   DISALLOW_COPY_AND_ASSIGN(ArchiveInstrumenter);
 };
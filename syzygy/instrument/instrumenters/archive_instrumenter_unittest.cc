@@ -14,7 +14,9 @@
 
 #include "syzygy/instrument/instrumenters/archive_instrumenter.h"
 
+#include "base/lazy_instance.h"
 #include "base/files/file_util.h"
+#include "base/synchronization/lock.h"
 #include "gtest/gtest.h"
 #include "syzygy/ar/unittest_util.h"
 #include "syzygy/core/unittest_util.h"
@@ -26,10 +28,9 @@ namespace instrumenters {
 
 namespace {
 
-// Some global state that is updated by IdentityInstrumenter.
-// NOTE: Because of these this unittest is not thread safe! We could do this
-//       with a complicate usage of gmock, but that's overkill for this
-//       scenario.
+// Some global state that is updated by IdentityInstrumenter. The files of an
+// archive are instrumented concurrently, so this is under state_lock.
+base::LazyInstance<base::Lock>::Leaky state_lock = LAZY_INSTANCE_INITIALIZER;
 size_t constructor_count = 0;
 size_t parse_count = 0;
 size_t instrument_count = 0;
@@ -40,22 +41,27 @@ std::set<base::FilePath> output_images;
 class IdentityInstrumenter : public InstrumenterInterface {
  public:
   IdentityInstrumenter() {
+    base::AutoLock auto_lock(state_lock.Get());
     ++constructor_count;
   }
 
   virtual bool ParseCommandLine(
       const base::CommandLine* command_line) override {
-    ++parse_count;
     input_image_ = command_line->GetSwitchValuePath("input-image");
     output_image_ = command_line->GetSwitchValuePath("output-image");
+
+    base::AutoLock auto_lock(state_lock.Get());
+    ++parse_count;
     input_images.insert(input_image_);
     output_images.insert(output_image_);
     return true;
   }
 
   virtual bool Instrument() override {
-    ++instrument_count;
     base::CopyFile(input_image_, output_image_);
+
+    base::AutoLock auto_lock(state_lock.Get());
+    ++instrument_count;
     return true;
   }
 
@@ -138,6 +144,26 @@ TEST_F(ArchiveInstrumenterTest, IteratesOverArchiveFiles) {
   EXPECT_TRUE(base::PathExists(output_image_));
 }
 
+TEST_F(ArchiveInstrumenterTest, IteratesOverArchiveFilesSerially) {
+  ArchiveInstrumenter inst(&IdentityInstrumenterFactory);
+  command_line_->AppendSwitchPath("input-image", zlib_lib_);
+  command_line_->AppendSwitchASCII("archive-jobs", "1");
+
+  EXPECT_TRUE(inst.ParseCommandLine(command_line_.get()));
+  EXPECT_TRUE(inst.Instrument());
+  EXPECT_EQ(testing::kArchiveFileCount, instrument_count);
+  EXPECT_EQ(testing::kArchiveFileCount, output_images.size());
+  EXPECT_TRUE(base::PathExists(output_image_));
+}
+
+TEST_F(ArchiveInstrumenterTest, ParseInvalidArchiveJobsFails) {
+  ArchiveInstrumenter inst(&IdentityInstrumenterFactory);
+  command_line_->AppendSwitchPath("input-image", zlib_lib_);
+  command_line_->AppendSwitchASCII("archive-jobs", "0");
+
+  EXPECT_FALSE(inst.ParseCommandLine(command_line_.get()));
+}
+
 TEST_F(ArchiveInstrumenterTest, AsanInstrumentArchive) {
   ArchiveInstrumenter inst(&AsanInstrumenterFactory);
   command_line_->AppendSwitchPath("input-image", zlib_lib_);
@@ -18,21 +18,69 @@
 
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
 #include "syzygy/application/application.h"
+#include "syzygy/grinder/indexed_frequency_data_serializer.h"
 #include "syzygy/instrument/transforms/allocation_filter_transform.h"
+#include "syzygy/pe/pe_file.h"
 
 namespace {
-  using instrument::transforms::AllocationFilterTransform;
+
+using grinder::basic_block_util::IndexedFrequencyInformation;
+using grinder::basic_block_util::IndexedFrequencyMap;
+using grinder::basic_block_util::ModuleIndexedFrequencyMap;
+using instrument::transforms::AllocationFilterTransform;
+
+// Loads the basic block entry counts of a module from a basic block entry or
+// branch profile, as produced by the grinder.
+// @param path The path to the profile.
+// @param signature The signature of the module.
+// @param frequencies Receives the frequencies of the module.
+// @returns true on success, false otherwise.
+bool LoadEntryCounts(const base::FilePath& path,
+                     const pe::PEFile::Signature& signature,
+                     IndexedFrequencyMap* frequencies) {
+  DCHECK_NE(static_cast<IndexedFrequencyMap*>(nullptr), frequencies);
+
+  ModuleIndexedFrequencyMap module_frequencies;
+  grinder::IndexedFrequencyDataSerializer serializer;
+  if (!serializer.LoadFromJson(path, &module_frequencies)) {
+    LOG(ERROR) << "Failed to load profile: " << path.value();
+    return false;
+  }
+
+  const IndexedFrequencyInformation* information = nullptr;
+  if (!grinder::basic_block_util::FindIndexedFrequencyInfo(
+          signature, module_frequencies, &information)) {
+    LOG(ERROR) << "The profile does not match the input module.";
+    return false;
+  }
+
+  // Both of these have the entry counts in their first column.
+  if (information->data_type !=
+          common::IndexedFrequencyData::BASIC_BLOCK_ENTRY &&
+      information->data_type != common::IndexedFrequencyData::BRANCH) {
+    LOG(ERROR) << "The profile does not contain basic block entry counts.";
+    return false;
+  }
+
+  *frequencies = information->frequency_map;
+  return true;
 }
 
+}  // namespace
+
 namespace instrument {
 namespace instrumenters {
 
 AsanInstrumenter::AsanInstrumenter()
     : use_interceptors_(true),
       remove_redundant_checks_(true),
+      coalesce_adjacent_checks_(false),
+      hoist_loop_invariant_checks_(false),
       use_liveness_analysis_(true),
       instrumentation_rate_(1.0),
+      check_budget_(0),
       asan_rtl_options_(false),
       hot_patching_(false) {
 }
@@ -45,7 +93,24 @@ bool AsanInstrumenter::ImageFormatIsSupported(ImageFormat image_format) {
   return false;
 }
 
+bool AsanInstrumenter::Instrument() {
+  if (!Super::Instrument())
+    return false;
+
+  // Only a successful run updates the cache.
+  if (!transform_cache_path_.empty() &&
+      !transform_cache_.Save(transform_cache_path_)) {
+    return false;
+  }
+
+  return true;
+}
+
 bool AsanInstrumenter::InstrumentPrepare() {
+  if (!transform_cache_path_.empty() &&
+      !transform_cache_.Load(transform_cache_path_)) {
+    return false;
+  }
   return true;
 }
 
@@ -66,18 +131,54 @@ bool AsanInstrumenter::InstrumentImpl() {
     }
   }
 
+  // Load the profile if one was provided.
+  if (!instrumentation_profile_path_.empty()) {
+    if (image_format_ != BlockGraph::PE_IMAGE) {
+      LOG(ERROR) << "Profile guided instrumentation is only supported for PE "
+                 << "images.";
+      return false;
+    }
+    pe::PEFile pe_file;
+    pe::PEFile::Signature signature;
+    if (!pe_file.Init(input_image_path_)) {
+      LOG(ERROR) << "Failed to read image: " << input_image_path_.value();
+      return false;
+    }
+    pe_file.GetSignature(&signature);
+    if (!LoadEntryCounts(instrumentation_profile_path_, signature,
+                         &instrumentation_profile_)) {
+      return false;
+    }
+  }
+
   asan_transform_.reset(new instrument::transforms::AsanTransform());
   asan_transform_->set_instrument_dll_name(agent_dll_);
   asan_transform_->set_use_interceptors(use_interceptors_);
   asan_transform_->set_use_liveness_analysis(use_liveness_analysis_);
   asan_transform_->set_remove_redundant_checks(remove_redundant_checks_);
+  asan_transform_->set_coalesce_adjacent_checks(coalesce_adjacent_checks_);
+  asan_transform_->set_hoist_loop_invariant_checks(
+      hoist_loop_invariant_checks_);
   asan_transform_->set_instrumentation_rate(instrumentation_rate_);
+  if (!instrumentation_profile_path_.empty()) {
+    asan_transform_->set_instrumentation_profile(&instrumentation_profile_);
+    asan_transform_->set_check_budget(check_budget_);
+  }
   asan_transform_->set_hot_patching(hot_patching_);
+  asan_transform_->set_num_decomposition_threads(decomposition_threads_);
+  if (!transform_cache_path_.empty())
+    asan_transform_->set_transform_cache(&transform_cache_);
 
   // Set up the filter if one was provided.
   if (filter.get()) {
     filter_.reset(filter.release());
     asan_transform_->set_filter(&filter_->filter);
+
+    // The filter is queried for every block and instruction, so index it with
+    // one bit per byte of the image.
+    filter_bitmap_.reset(
+        new block_graph::RelativeAddressBitmapFilter(filter_->filter, 1));
+    asan_transform_->set_bitmap_filter(filter_bitmap_.get());
   }
 
   // Set overwrite source range flag in the Asan transform. The Asan
@@ -110,8 +211,11 @@ bool AsanInstrumenter::DoCommandLineParse(
   filter_path_ = command_line->GetSwitchValuePath("filter");
   use_liveness_analysis_ = !command_line->HasSwitch("no-liveness-analysis");
   remove_redundant_checks_ = !command_line->HasSwitch("no-redundancy-analysis");
+  coalesce_adjacent_checks_ = command_line->HasSwitch("coalesce-checks");
+  hoist_loop_invariant_checks_ = command_line->HasSwitch("hoist-loop-checks");
   use_interceptors_ = !command_line->HasSwitch("no-interceptors");
   hot_patching_ = command_line->HasSwitch("hot-patching");
+  transform_cache_path_ = command_line->GetSwitchValuePath("transform-cache");
 
   // Parse the instrumentation rate if one has been provided.
   static const char kInstrumentationRate[] = "instrumentation-rate";
@@ -126,6 +230,25 @@ bool AsanInstrumenter::DoCommandLineParse(
     instrumentation_rate_ = std::max(0.0, std::min(1.0, d));
   }
 
+  // The profile guided instrumentation needs both a profile and a budget.
+  static const char kInstrumentationProfile[] = "instrumentation-profile";
+  static const char kCheckBudget[] = "check-budget";
+  instrumentation_profile_path_ =
+      command_line->GetSwitchValuePath(kInstrumentationProfile);
+  if (command_line->HasSwitch(kCheckBudget)) {
+    std::string s = command_line->GetSwitchValueASCII(kCheckBudget);
+    if (!base::StringToUint64(s, &check_budget_)) {
+      LOG(ERROR) << "Failed to parse check budget: " << s;
+      return false;
+    }
+  }
+  if (instrumentation_profile_path_.empty() ==
+      command_line->HasSwitch(kCheckBudget)) {
+    LOG(ERROR) << "--" << kInstrumentationProfile << " and --" << kCheckBudget
+               << " must be used together.";
+    return false;
+  }
+
   // Parse Asan RTL options if present.
   asan_rtl_options_ = command_line->HasSwitch(common::kAsanRtlOptions);
   if (asan_rtl_options_) {
@@ -19,7 +19,9 @@
 #include <string>
 
 #include "base/command_line.h"
+#include "syzygy/block_graph/block_transform_cache.h"
 #include "syzygy/common/asan_parameters.h"
+#include "syzygy/grinder/basic_block_util.h"
 #include "syzygy/instrument/instrumenters/instrumenter_with_agent.h"
 #include "syzygy/instrument/transforms/allocation_filter_transform.h"
 #include "syzygy/instrument/transforms/asan_transform.h"
@@ -36,6 +38,11 @@ class AsanInstrumenter : public InstrumenterWithAgent {
   AsanInstrumenter();
   ~AsanInstrumenter() { }
 
+  // @name InstrumenterInterface overrides.
+  // @{
+  bool Instrument() override;
+  // @}
+
  protected:
   // @name InstrumenterWithAgent overrides.
   // @{
@@ -55,10 +62,15 @@ class AsanInstrumenter : public InstrumenterWithAgent {
   base::FilePath filter_path_;
   bool use_interceptors_;
   bool remove_redundant_checks_;
+  bool coalesce_adjacent_checks_;
+  bool hoist_loop_invariant_checks_;
   bool use_liveness_analysis_;
   double instrumentation_rate_;
+  base::FilePath instrumentation_profile_path_;
+  uint64_t check_budget_;
   bool asan_rtl_options_;
   bool hot_patching_;
+  base::FilePath transform_cache_path_;
   // @}
 
   // Valid if asan_rtl_options_ is true.
@@ -67,9 +79,21 @@ class AsanInstrumenter : public InstrumenterWithAgent {
   // The transform for this agent.
   std::unique_ptr<instrument::transforms::AsanTransform> asan_transform_;
 
+  // The basic block entry counts guiding the instrumentation density. Valid if
+  // instrumentation_profile_path_ isn't empty.
+  grinder::basic_block_util::IndexedFrequencyMap instrumentation_profile_;
+
+  // The cache of the instrumented blocks. Valid if transform_cache_path_ isn't
+  // empty.
+  block_graph::BlockTransformCache transform_cache_;
+
   // The image filter (optional).
   std::unique_ptr<pe::ImageFilter> filter_;
 
+  // A bitmap of the image filter, for constant time lookups by the transform.
+  // Valid if filter_ is.
+  std::unique_ptr<block_graph::RelativeAddressBitmapFilter> filter_bitmap_;
+
   // Path to the JSON configuration file for the AllocationFilter transform.
   // The AllocationFilter tranform is only applied if this config file is
   // specified.
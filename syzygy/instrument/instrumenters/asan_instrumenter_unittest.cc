@@ -38,17 +38,23 @@ class TestAsanInstrumenter : public AsanInstrumenter {
   using AsanInstrumenter::allow_overwrite_;
   using AsanInstrumenter::asan_params_;
   using AsanInstrumenter::asan_rtl_options_;
+  using AsanInstrumenter::check_budget_;
+  using AsanInstrumenter::coalesce_adjacent_checks_;
+  using AsanInstrumenter::hoist_loop_invariant_checks_;
   using AsanInstrumenter::debug_friendly_;
+  using AsanInstrumenter::decomposition_threads_;
   using AsanInstrumenter::filter_path_;
   using AsanInstrumenter::hot_patching_;
   using AsanInstrumenter::input_image_path_;
   using AsanInstrumenter::input_pdb_path_;
+  using AsanInstrumenter::instrumentation_profile_path_;
   using AsanInstrumenter::instrumentation_rate_;
   using AsanInstrumenter::no_augment_pdb_;
   using AsanInstrumenter::no_strip_strings_;
   using AsanInstrumenter::output_image_path_;
   using AsanInstrumenter::output_pdb_path_;
   using AsanInstrumenter::remove_redundant_checks_;
+  using AsanInstrumenter::transform_cache_path_;
   using AsanInstrumenter::use_interceptors_;
   using AsanInstrumenter::use_liveness_analysis_;
   using InstrumenterWithAgent::CreateRelinker;
@@ -154,19 +160,31 @@ TEST_F(AsanInstrumenterTest, ParseMinimalAsan) {
   EXPECT_FALSE(instrumenter_.no_augment_pdb_);
   EXPECT_FALSE(instrumenter_.no_strip_strings_);
   EXPECT_FALSE(instrumenter_.debug_friendly_);
+  EXPECT_EQ(0u, instrumenter_.decomposition_threads_);
   EXPECT_TRUE(instrumenter_.use_interceptors_);
   EXPECT_TRUE(instrumenter_.use_liveness_analysis_);
   EXPECT_TRUE(instrumenter_.remove_redundant_checks_);
+  EXPECT_FALSE(instrumenter_.coalesce_adjacent_checks_);
+  EXPECT_FALSE(instrumenter_.hoist_loop_invariant_checks_);
   EXPECT_EQ(1.0, instrumenter_.instrumentation_rate_);
+  EXPECT_TRUE(instrumenter_.instrumentation_profile_path_.empty());
+  EXPECT_EQ(0U, instrumenter_.check_budget_);
   EXPECT_FALSE(instrumenter_.asan_rtl_options_);
   EXPECT_FALSE(instrumenter_.hot_patching_);
+  EXPECT_TRUE(instrumenter_.transform_cache_path_.empty());
 }
 
 TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   SetUpValidCommandLine();
+  base::FilePath profile_path(L"profile.json");
+  base::FilePath cache_path(L"cache.bin");
   cmd_line_.AppendSwitchPath("filter", test_dll_filter_path_);
   cmd_line_.AppendSwitchASCII("agent", "foo.dll");
+  cmd_line_.AppendSwitchASCII("check-budget", "1000000");
+  cmd_line_.AppendSwitch("coalesce-checks");
   cmd_line_.AppendSwitch("debug-friendly");
+  cmd_line_.AppendSwitchASCII("decomposition-threads", "4");
+  cmd_line_.AppendSwitch("hoist-loop-checks");
   cmd_line_.AppendSwitch("hot-patching");
   cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
   cmd_line_.AppendSwitch("no-augment-pdb");
@@ -177,6 +195,8 @@ TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   cmd_line_.AppendSwitch("no-liveness-analysis");
   cmd_line_.AppendSwitch("no-redundancy-analysis");
   cmd_line_.AppendSwitchASCII("instrumentation-rate", "0.5");
+  cmd_line_.AppendSwitchPath("instrumentation-profile", profile_path);
+  cmd_line_.AppendSwitchPath("transform-cache", cache_path);
   cmd_line_.AppendSwitchASCII(
       common::kAsanRtlOptions,
       "\"--quarantine_size=1024 --quarantine_block_size=512 --ignored\"");
@@ -193,12 +213,18 @@ TEST_F(AsanInstrumenterTest, ParseFullAsan) {
   EXPECT_TRUE(instrumenter_.no_augment_pdb_);
   EXPECT_TRUE(instrumenter_.no_strip_strings_);
   EXPECT_TRUE(instrumenter_.debug_friendly_);
+  EXPECT_EQ(4u, instrumenter_.decomposition_threads_);
   EXPECT_FALSE(instrumenter_.use_interceptors_);
   EXPECT_FALSE(instrumenter_.use_liveness_analysis_);
   EXPECT_FALSE(instrumenter_.remove_redundant_checks_);
+  EXPECT_TRUE(instrumenter_.coalesce_adjacent_checks_);
+  EXPECT_TRUE(instrumenter_.hoist_loop_invariant_checks_);
   EXPECT_EQ(0.5, instrumenter_.instrumentation_rate_);
+  EXPECT_EQ(profile_path, instrumenter_.instrumentation_profile_path_);
+  EXPECT_EQ(1000000U, instrumenter_.check_budget_);
   EXPECT_TRUE(instrumenter_.asan_rtl_options_);
   EXPECT_TRUE(instrumenter_.hot_patching_);
+  EXPECT_EQ(cache_path, instrumenter_.transform_cache_path_);
 
   // We check that the requested RTL options were parsed, and that others are
   // left to their defaults. We don't check all the parameters as other
@@ -253,6 +279,25 @@ TEST_F(AsanInstrumenterTest, FailsWithInvalidInstrumentationRate) {
   EXPECT_FALSE(instrumenter_.ParseCommandLine(&cmd_line_));
 }
 
+TEST_F(AsanInstrumenterTest, FailsWithInvalidCheckBudget) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchPath("instrumentation-profile",
+                             base::FilePath(L"profile.json"));
+  cmd_line_.AppendSwitchASCII("check-budget", "-12");
+
+  EXPECT_FALSE(instrumenter_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(AsanInstrumenterTest, FailsWithProfileWithoutCheckBudget) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchPath("instrumentation-profile",
+                             base::FilePath(L"profile.json"));
+
+  EXPECT_FALSE(instrumenter_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(AsanInstrumenterTest, FailsWithInvalidAsanRtlOptions) {
   cmd_line_.AppendSwitchPath("input-image", input_image_path_);
   cmd_line_.AppendSwitchPath("output-image", output_image_path_);
@@ -40,6 +40,7 @@ bool BasicBlockEntryInstrumenter::InstrumentImpl() {
   bbentry_transform_->set_instrument_dll_name(agent_dll_);
   bbentry_transform_->set_inline_fast_path(inline_fast_path_);
   bbentry_transform_->set_src_ranges_for_thunks(debug_friendly_);
+  bbentry_transform_->set_num_decomposition_threads(decomposition_threads_);
   if (!relinker_->AppendTransform(bbentry_transform_.get()))
     return false;
 
@@ -36,6 +36,7 @@ class TestBasicBlockEntryInstrumenter : public BasicBlockEntryInstrumenter {
   using BasicBlockEntryInstrumenter::no_strip_strings_;
   using BasicBlockEntryInstrumenter::inline_fast_path_;
   using BasicBlockEntryInstrumenter::debug_friendly_;
+  using BasicBlockEntryInstrumenter::decomposition_threads_;
   using BasicBlockEntryInstrumenter::kAgentDllBasicBlockEntry;
   using BasicBlockEntryInstrumenter::InstrumentPrepare;
   using BasicBlockEntryInstrumenter::InstrumentImpl;
@@ -124,12 +125,14 @@ TEST_F(BasicBlockEntryInstrumenterTest, ParseMinimalBasicBlockEntry) {
   EXPECT_FALSE(instrumenter_.no_strip_strings_);
   EXPECT_FALSE(instrumenter_.debug_friendly_);
   EXPECT_FALSE(instrumenter_.inline_fast_path_);
+  EXPECT_EQ(0u, instrumenter_.decomposition_threads_);
 }
 
 TEST_F(BasicBlockEntryInstrumenterTest, ParseFullBasicBlockEntry) {
   SetUpValidCommandLine();
   cmd_line_.AppendSwitchASCII("agent", "foo.dll");
   cmd_line_.AppendSwitch("debug-friendly");
+  cmd_line_.AppendSwitchASCII("decomposition-threads", "4");
   cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
   cmd_line_.AppendSwitch("no-augment-pdb");
   cmd_line_.AppendSwitch("no-strip-strings");
@@ -149,6 +152,14 @@ TEST_F(BasicBlockEntryInstrumenterTest, ParseFullBasicBlockEntry) {
   EXPECT_TRUE(instrumenter_.no_augment_pdb_);
   EXPECT_TRUE(instrumenter_.no_strip_strings_);
   EXPECT_TRUE(instrumenter_.debug_friendly_);
+  EXPECT_EQ(4u, instrumenter_.decomposition_threads_);
+}
+
+TEST_F(BasicBlockEntryInstrumenterTest, ParseInvalidDecompositionThreads) {
+  SetUpValidCommandLine();
+  cmd_line_.AppendSwitchASCII("decomposition-threads", "many");
+
+  EXPECT_FALSE(instrumenter_.ParseCommandLine(&cmd_line_));
 }
 
 TEST_F(BasicBlockEntryInstrumenterTest, InstrumentImpl) {
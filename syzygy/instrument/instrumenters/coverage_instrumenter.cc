@@ -24,7 +24,7 @@ namespace instrumenters {
 
 const char CoverageInstrumenter::kAgentDllCoverage[] = "coverage_client.dll";
 
-CoverageInstrumenter::CoverageInstrumenter() {
+CoverageInstrumenter::CoverageInstrumenter() : inline_bitmap_(false) {
   agent_dll_ = kAgentDllCoverage;
 }
 
@@ -37,6 +37,7 @@ bool CoverageInstrumenter::InstrumentImpl() {
       new instrument::transforms::CoverageInstrumentationTransform());
   coverage_transform_->set_instrument_dll_name(agent_dll_);
   coverage_transform_->set_src_ranges_for_thunks(debug_friendly_);
+  coverage_transform_->set_inline_bitmap(inline_bitmap_);
   if (!relinker_->AppendTransform(coverage_transform_.get()))
     return false;
 
@@ -50,5 +51,16 @@ bool CoverageInstrumenter::InstrumentImpl() {
   return true;
 }
 
+bool CoverageInstrumenter::DoCommandLineParse(
+    const base::CommandLine* command_line) {
+  if (!Super::DoCommandLineParse(command_line))
+    return false;
+
+  // Parse the additional command line arguments.
+  inline_bitmap_ = command_line->HasSwitch("inline-bitmap");
+
+  return true;
+}
+
 }  // namespace instrumenters
 }  // namespace instrument
@@ -44,6 +44,16 @@ class CoverageInstrumenter : public InstrumenterWithAgent {
   const char* InstrumentationMode() override { return "coverage"; }
   // @}
 
+  // @name Super overrides.
+  // @{
+  bool DoCommandLineParse(const base::CommandLine* command_line) override;
+  // @}
+
+  // @name Command-line parameters.
+  // @{
+  bool inline_bitmap_;
+  // @}
+
   // The transform for this agent.
   std::unique_ptr<instrument::transforms::CoverageInstrumentationTransform>
       coverage_transform_;
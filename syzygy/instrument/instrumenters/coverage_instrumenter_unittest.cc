@@ -35,6 +35,7 @@ class TestCoverageInstrumenter : public CoverageInstrumenter {
   using CoverageInstrumenter::no_augment_pdb_;
   using CoverageInstrumenter::no_strip_strings_;
   using CoverageInstrumenter::debug_friendly_;
+  using CoverageInstrumenter::inline_bitmap_;
   using CoverageInstrumenter::kAgentDllCoverage;
   using CoverageInstrumenter::InstrumentPrepare;
   using CoverageInstrumenter::InstrumentImpl;
@@ -121,12 +122,14 @@ TEST_F(CoverageInstrumenterTest, ParseMinimalCoverage) {
   EXPECT_FALSE(instrumenter_.no_augment_pdb_);
   EXPECT_FALSE(instrumenter_.no_strip_strings_);
   EXPECT_FALSE(instrumenter_.debug_friendly_);
+  EXPECT_FALSE(instrumenter_.inline_bitmap_);
 }
 
 TEST_F(CoverageInstrumenterTest, ParseFullCoverage) {
   SetUpValidCommandLine();
   cmd_line_.AppendSwitchASCII("agent", "foo.dll");
   cmd_line_.AppendSwitch("debug-friendly");
+  cmd_line_.AppendSwitch("inline-bitmap");
   cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
   cmd_line_.AppendSwitch("no-augment-pdb");
   cmd_line_.AppendSwitch("no-strip-strings");
@@ -144,6 +147,7 @@ TEST_F(CoverageInstrumenterTest, ParseFullCoverage) {
   EXPECT_TRUE(instrumenter_.no_augment_pdb_);
   EXPECT_TRUE(instrumenter_.no_strip_strings_);
   EXPECT_TRUE(instrumenter_.debug_friendly_);
+  EXPECT_TRUE(instrumenter_.inline_bitmap_);
 }
 
 TEST_F(CoverageInstrumenterTest, InstrumentImpl) {
@@ -16,8 +16,10 @@
 
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
 #include "syzygy/application/application.h"
 #include "syzygy/core/file_util.h"
+#include "syzygy/core/phase_profiler.h"
 
 namespace instrument {
 namespace instrumenters {
@@ -99,10 +101,34 @@ bool InstrumenterWithRelinker::DoCommandLineParse(
       command_line->GetSwitchValuePath("input-pdb"));
   output_pdb_path_ = application::AppImplBase::AbsolutePath(
       command_line->GetSwitchValuePath("output-pdb"));
+  phase_profile_path_ = command_line->GetSwitchValuePath("phase-profile");
   allow_overwrite_ = command_line->HasSwitch("overwrite");
   debug_friendly_ = command_line->HasSwitch("debug-friendly");
   no_augment_pdb_ = command_line->HasSwitch("no-augment-pdb");
   no_strip_strings_ = command_line->HasSwitch("no-strip-strings");
+  arena_storage_ = command_line->HasSwitch("arena-storage");
+
+  static const char kDecompositionThreads[] = "decomposition-threads";
+  if (command_line->HasSwitch(kDecompositionThreads)) {
+    std::string s = command_line->GetSwitchValueASCII(kDecompositionThreads);
+    unsigned threads = 0;
+    if (!base::StringToUint(s, &threads)) {
+      LOG(ERROR) << "Failed to parse number of decomposition threads: " << s;
+      return false;
+    }
+    decomposition_threads_ = threads;
+  }
+
+  static const char kPdbReaderThreads[] = "pdb-reader-threads";
+  if (command_line->HasSwitch(kPdbReaderThreads)) {
+    std::string s = command_line->GetSwitchValueASCII(kPdbReaderThreads);
+    unsigned threads = 0;
+    if (!base::StringToUint(s, &threads)) {
+      LOG(ERROR) << "Failed to parse number of PDB reader threads: " << s;
+      return false;
+    }
+    pdb_reader_threads_ = threads;
+  }
 
   return true;
 }
@@ -119,6 +145,12 @@ bool InstrumenterWithRelinker::Instrument() {
   if (!CreateRelinker())
     return false;
 
+  // Profile the phases of the relink if asked to.
+  core::PhaseProfiler profiler;
+  std::unique_ptr<core::PhaseProfiler::ScopedCurrent> scoped_profiler;
+  if (!phase_profile_path_.empty())
+    scoped_profiler.reset(new core::PhaseProfiler::ScopedCurrent(&profiler));
+
   // Initialize the relinker. This does the decomposition, etc.
   if (!relinker_->Init()) {
     LOG(ERROR) << "Failed to initialize relinker.";
@@ -136,6 +168,11 @@ bool InstrumenterWithRelinker::Instrument() {
     return false;
   }
 
+  if (!phase_profile_path_.empty() &&
+      !profiler.SaveToJSON(phase_profile_path_, true)) {
+    return false;
+  }
+
   return true;
 }
 
@@ -195,6 +232,7 @@ bool InstrumenterWithRelinker::CreateRelinker() {
     relinker->set_input_path(input_image_path_);
     relinker->set_output_path(output_image_path_);
     relinker->set_allow_overwrite(allow_overwrite_);
+    relinker->set_decomposer_threads(decomposition_threads_);
   } else {
     pe::PERelinker* relinker = GetPERelinker();
     DCHECK_NE(reinterpret_cast<pe::PERelinker*>(nullptr), relinker);
@@ -206,6 +244,8 @@ bool InstrumenterWithRelinker::CreateRelinker() {
     relinker->set_allow_overwrite(allow_overwrite_);
     relinker->set_augment_pdb(!no_augment_pdb_);
     relinker->set_strip_strings(!no_strip_strings_);
+    relinker->set_pdb_reader_threads(pdb_reader_threads_);
+    relinker->set_arena_storage(arena_storage_);
   }
 
   DCHECK_EQ(image_format_, relinker_->image_format());
@@ -40,9 +40,12 @@ class InstrumenterWithRelinker : public InstrumenterInterface {
   InstrumenterWithRelinker()
       : image_format_(BlockGraph::PE_IMAGE),
         allow_overwrite_(false),
+        arena_storage_(false),
         debug_friendly_(false),
+        decomposition_threads_(0),
         no_augment_pdb_(false),
-        no_strip_strings_(false) { }
+        no_strip_strings_(false),
+        pdb_reader_threads_(0) { }
 
   ~InstrumenterWithRelinker() { }
 
@@ -104,10 +107,14 @@ class InstrumenterWithRelinker : public InstrumenterInterface {
   base::FilePath input_pdb_path_;
   base::FilePath output_image_path_;
   base::FilePath output_pdb_path_;
+  base::FilePath phase_profile_path_;
   bool allow_overwrite_;
+  bool arena_storage_;
   bool debug_friendly_;
+  size_t decomposition_threads_;
   bool no_augment_pdb_;
   bool no_strip_strings_;
+  size_t pdb_reader_threads_;
   // @}
 
   // This is used to save a pointer to the object returned by the call to
@@ -61,8 +61,10 @@ class TestInstrumenterWithRelinker : public InstrumenterWithRelinker {
   using InstrumenterWithRelinker::output_image_path_;
   using InstrumenterWithRelinker::output_pdb_path_;
   using InstrumenterWithRelinker::allow_overwrite_;
+  using InstrumenterWithRelinker::arena_storage_;
   using InstrumenterWithRelinker::no_augment_pdb_;
   using InstrumenterWithRelinker::no_strip_strings_;
+  using InstrumenterWithRelinker::pdb_reader_threads_;
 
   TestInstrumenterWithRelinker() {
   }
@@ -193,8 +195,34 @@ TEST_F(InstrumenterWithRelinkerTest, ParseInputImages) {
   EXPECT_EQ(output_pe_image_path_, instrumenter.output_image_path_);
 
   EXPECT_FALSE(instrumenter.allow_overwrite_);
+  EXPECT_FALSE(instrumenter.arena_storage_);
   EXPECT_FALSE(instrumenter.no_augment_pdb_);
   EXPECT_FALSE(instrumenter.no_strip_strings_);
+  EXPECT_EQ(0u, instrumenter.pdb_reader_threads_);
+}
+
+TEST_F(InstrumenterWithRelinkerTest, ParseArenaStorage) {
+  cmd_line_.AppendSwitchPath("input-image", input_pe_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_pe_image_path_);
+  cmd_line_.AppendSwitch("arena-storage");
+
+  TestInstrumenterWithRelinker instrumenter;
+  EXPECT_TRUE(instrumenter.ParseCommandLine(&cmd_line_));
+  EXPECT_TRUE(instrumenter.arena_storage_);
+}
+
+TEST_F(InstrumenterWithRelinkerTest, ParsePdbReaderThreads) {
+  cmd_line_.AppendSwitchPath("input-image", input_pe_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_pe_image_path_);
+  cmd_line_.AppendSwitchASCII("pdb-reader-threads", "4");
+
+  TestInstrumenterWithRelinker instrumenter;
+  EXPECT_TRUE(instrumenter.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(4u, instrumenter.pdb_reader_threads_);
+
+  cmd_line_.AppendSwitchASCII("pdb-reader-threads", "four");
+  TestInstrumenterWithRelinker bad_instrumenter;
+  EXPECT_FALSE(bad_instrumenter.ParseCommandLine(&cmd_line_));
 }
 
 TEST_F(InstrumenterWithRelinkerTest, InstrumentPE) {
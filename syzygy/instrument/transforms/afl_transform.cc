@@ -17,6 +17,8 @@
 #include <algorithm>
 #include <random>
 
+#include "base/strings/stringprintf.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/block_graph/block_util.h"
 #include "syzygy/block_graph/typed_block.h"
 #include "syzygy/instrument/transforms/add_implicit_tls_transform.h"
@@ -37,16 +39,23 @@ class RandomCtr {
     std::shuffle(numbers_.begin(), numbers_.end(), g);
   }
 
-  size_t next() { return numbers_[idx_++ % numbers_.size()]; }
+  size_t next() {
+    base::AutoLock auto_lock(lock_);
+    return numbers_[idx_++ % numbers_.size()];
+  }
 
  private:
   std::vector<size_t> numbers_;
+  // Images may be instrumented concurrently in batch mode.
+  base::Lock lock_;
   size_t idx_;
 };
 
 namespace instrument {
 namespace transforms {
 
+// The size of the coverage bitmap of AFL. In the edge indexing mode, the
+// bitmap is grown past this as needed.
 static const size_t kMapSize = 1 << 16;
 
 #pragma pack(push, 1)
@@ -62,9 +71,11 @@ struct StaticCoverageData {
 
 #pragma pack(pop)
 
+using block_graph::BasicBlockReference;
 using block_graph::Displacement;
 using block_graph::Operand;
 using block_graph::Immediate;
+using block_graph::Successor;
 
 const char AFLTransform::kTransformName[] = "AFLTransform";
 const char AFLTransform::kSectionName[] = ".syzyafl";
@@ -126,7 +137,7 @@ bool AFLTransform::PreBlockGraphIteration(
     }
   }
 
-  if (multithread_) {
+  if (multithread_ && !edge_indexing_) {
     // If we have the multithread enabled, the 'afl_prev_loc' variable is stored
     // in an implicit TLS slot.
     AddImplicitTlsTransform afl_prev_loc_tls(afl_static_cov_data_,
@@ -244,6 +255,21 @@ bool AFLTransform::PostBlockGraphIteration(
   VLOG(1) << "       Code Blocks found: " << total_code_blocks_;
   LOG(INFO) << "Code Blocks instrumented: " << total_code_blocks_instrumented_
             << " (" << instrumentation_percentage << "%)";
+
+  map_size_ = kMapSize;
+  if (edge_indexing_) {
+    // Grow the bitmap to the next power of two that fits all the counters.
+    while (map_size_ < num_counters_)
+      map_size_ <<= 1;
+    afl_static_cov_data_->set_size(kOffsetArea + map_size_);
+
+    LOG(INFO) << "        Counters indexed: " << num_counters_;
+    if (map_size_ != kMapSize) {
+      LOG(WARNING) << "The coverage bitmap holds " << map_size_ << " bytes, "
+                   << "the fuzzer must be built with a MAP_SIZE that large.";
+    }
+  }
+
   return true;
 }
 
@@ -310,6 +336,76 @@ void AFLTransform::instrument(BasicBlockAssembler& assm, size_t rand_id) {
   assm.pop(assm::eax);
 }
 
+void AFLTransform::IncrementCounter(BasicBlockAssembler& assm,
+                                    const LivenessAnalysis::State& state,
+                                    size_t index) {
+  // inc byte [afl_area + index]
+  BasicBlockAssembler::Operand counter(
+      Displacement(afl_static_cov_data_, kOffsetArea + index));
+
+  if (!state.AreArithmeticFlagsLive()) {
+    assm.inc(counter);
+    return;
+  }
+
+  // Save the flags, and eax which they get saved into.
+  bool save_eax = state.IsLive(assm::eax);
+  if (save_eax)
+    assm.push(assm::eax);
+  assm.lahf();
+  assm.set(assm::kOverflow, assm::eax);
+
+  assm.inc(counter);
+
+  assm.add(assm::al, Immediate(0x7F, assm::kSize8Bit));
+  assm.sahf();
+  if (save_eax)
+    assm.pop(assm::eax);
+}
+
+void AFLTransform::AddEdgeCounters(
+    const LivenessAnalysis& liveness,
+    BasicBlockSubGraph::BasicBlockOrdering* ordering,
+    BasicBlockSubGraph* subgraph,
+    BasicCodeBlock* bb) {
+  DCHECK_NE(static_cast<BasicBlockSubGraph::BasicBlockOrdering*>(nullptr),
+            ordering);
+  DCHECK_NE(static_cast<BasicBlockSubGraph*>(nullptr), subgraph);
+  DCHECK_NE(static_cast<BasicCodeBlock*>(nullptr), bb);
+
+  BasicBlock::Successors& successors = bb->successors();
+  if (successors.size() < 2)
+    return;
+
+  for (auto& successor : successors) {
+    // Leaving the block is counted by the entry counter of the destination.
+    BasicBlock* destination = successor.reference().basic_block();
+    if (destination == nullptr)
+      continue;
+
+    // Route the edge through a basic block that counts it.
+    BasicCodeBlock* edge_bb = subgraph->AddBasicCodeBlock(
+        base::StringPrintf("%s_edge_%d", bb->name().c_str(),
+                           static_cast<int>(num_counters_)));
+    ordering->push_back(edge_bb);
+
+    LivenessAnalysis::State state;
+    liveness.GetStateAtEntryOf(destination, &state);
+    BasicBlockAssembler assm(edge_bb->instructions().begin(),
+                             &edge_bb->instructions());
+    IncrementCounter(assm, state, num_counters_++);
+
+    edge_bb->successors().push_back(Successor(
+        Successor::kConditionTrue,
+        BasicBlockReference(BlockGraph::RELATIVE_REF,
+                            BlockGraph::Reference::kMaximumSize, destination),
+        0));
+    successor.set_reference(
+        BasicBlockReference(BlockGraph::RELATIVE_REF,
+                            BlockGraph::Reference::kMaximumSize, edge_bb));
+  }
+}
+
 // This is the PRNG used to assign random IDs to basic-blocks.
 static RandomCtr random_ctr(kMapSize);
 
@@ -317,21 +413,44 @@ bool AFLTransform::TransformBasicBlockSubGraph(
     const TransformPolicyInterface* policy,
     BlockGraph* block_graph,
     BasicBlockSubGraph* basic_block_subgraph) {
-  // Iterate through every basic-block and instrument them.
-  BasicBlockSubGraph::BBCollection& basic_blocks =
-      basic_block_subgraph->basic_blocks();
-
-  for (auto& bb : basic_blocks) {
+  // Iterate through every basic-block and instrument them. In the edge
+  // indexing mode new basic blocks are added along the way, so collect the
+  // original ones first, along with the ordering they belong to.
+  std::vector<BasicCodeBlock*> code_blocks;
+  for (auto& bb : basic_block_subgraph->basic_blocks()) {
     BasicCodeBlock* bc_block = BasicCodeBlock::Cast(bb);
-    if (bc_block == nullptr) {
-      continue;
+    if (bc_block != nullptr)
+      code_blocks.push_back(bc_block);
+  }
+
+  std::map<BasicBlock*, BasicBlockSubGraph::BasicBlockOrdering*> orderings;
+  if (edge_indexing_) {
+    for (auto& description : basic_block_subgraph->block_descriptions()) {
+      for (BasicBlock* bb : description.basic_block_order)
+        orderings[bb] = &description.basic_block_order;
     }
+  }
 
+  // The liveness information lets the counters skip saving the flags.
+  LivenessAnalysis liveness;
+  if (edge_indexing_)
+    liveness.Analyze(basic_block_subgraph);
+
+  for (BasicCodeBlock* bc_block : code_blocks) {
     BasicBlock::Instructions& instructions = bc_block->instructions();
     BasicBlockAssembler assm(instructions.begin(), &instructions);
 
-    size_t rand_id = random_ctr.next();
-    instrument(assm, rand_id);
+    if (edge_indexing_) {
+      LivenessAnalysis::State state;
+      liveness.GetStateAtEntryOf(bc_block, &state);
+      IncrementCounter(assm, state, num_counters_++);
+      DCHECK_NE(0U, orderings.count(bc_block));
+      AddEdgeCounters(liveness, orderings[bc_block], basic_block_subgraph,
+                      bc_block);
+    } else {
+      size_t rand_id = random_ctr.next();
+      instrument(assm, rand_id);
+    }
 
     BlockGraph::Block::SourceRange source_range;
     if (!GetBasicBlockSourceRange(*bc_block, &source_range)) {
@@ -20,6 +20,12 @@
 // For more information about AFL & WinAFL, technical details can be found here:
 // http://lcamtuf.coredump.cx/afl/technical_details.txt and here:
 // https://github.com/ivanfratric/winafl.
+//
+// By default each basic block gets a random ID and the edges are hashed into
+// the coverage bitmap the way AFL does, which collides on large binaries. In
+// the edge indexing mode, the transform instead gives every basic block and
+// every edge leaving a conditional branch a counter of its own in the bitmap,
+// and sizes the bitmap to fit all of them.
 
 #ifndef SYZYGY_INSTRUMENT_TRANSFORMS_AFL_TRANSFORM_H_
 #define SYZYGY_INSTRUMENT_TRANSFORMS_AFL_TRANSFORM_H_
@@ -31,6 +37,7 @@
 #include "syzygy/block_graph/transform_policy.h"
 #include "syzygy/block_graph/transforms/iterative_transform.h"
 #include "syzygy/block_graph/transforms/named_transform.h"
+#include "syzygy/block_graph/analysis/liveness_analysis.h"
 
 namespace instrument {
 namespace transforms {
@@ -44,6 +51,7 @@ typedef core::RelativeAddress RelativeAddress;
 typedef core::AddressRange<RelativeAddress, size_t> RelativeAddressRange;
 typedef std::vector<RelativeAddressRange> RelativeAddressRangeVector;
 typedef block_graph::TransformPolicyInterface TransformPolicyInterface;
+typedef block_graph::analysis::LivenessAnalysis LivenessAnalysis;
 
 class AFLTransform
     : public block_graph::transforms::IterativeTransformImpl<AFLTransform>,
@@ -73,6 +81,9 @@ class AFLTransform
         force_decompose_(force_decompose),
         multithread_(multithread),
         cookie_check_hook_(cookie_check_hook),
+        edge_indexing_(false),
+        num_counters_(0),
+        map_size_(0),
         total_blocks_(0),
         total_code_blocks_(0),
         total_code_blocks_instrumented_(0) {
@@ -115,11 +126,37 @@ class AFLTransform
 
   const RelativeAddressRangeVector& bb_ranges() { return bb_ranges_; }
 
+  // Enables the edge indexing mode. In this mode the instrumentation doesn't
+  // keep track of the previous location, so there is nothing to make
+  // thread-safe.
+  void set_edge_indexing(bool edge_indexing) {
+    edge_indexing_ = edge_indexing;
+  }
+  bool edge_indexing() const { return edge_indexing_; }
+
+  // @returns the size of the coverage bitmap. This is only valid after the
+  //     transform has been applied.
+  size_t map_size() const { return map_size_; }
+
  protected:
   // Basic-block instrumentation related functions.
   bool ShouldInstrumentBlock(BlockGraph::Block* block);
   void instrument(BasicBlockAssembler& assm, size_t cur_loc);
 
+  // Edge indexing related functions.
+  // Emits the increment of the counter at @p index of the bitmap, saving the
+  // arithmetic flags and eax only if @p state says they may be in use.
+  void IncrementCounter(BasicBlockAssembler& assm,
+                        const LivenessAnalysis::State& state,
+                        size_t index);
+  // Counts each edge leaving @p bb toward a basic block of @p subgraph in an
+  // edge basic block of its own, appended to @p ordering. The edges of a
+  // basic block with a single successor are counted by its entry counter.
+  void AddEdgeCounters(const LivenessAnalysis& liveness,
+                       BasicBlockSubGraph::BasicBlockOrdering* ordering,
+                       BasicBlockSubGraph* subgraph,
+                       BasicCodeBlock* bb);
+
   // The data-block that keeps the metadata regarding the instrumentation.
   BlockGraph::Block* afl_static_cov_data_;
 
@@ -139,6 +176,12 @@ class AFLTransform
   bool force_decompose_;
   bool multithread_;
   bool cookie_check_hook_;
+  bool edge_indexing_;
+
+  // In the edge indexing mode, the number of counters handed out so far, and
+  // the size of the bitmap.
+  size_t num_counters_;
+  size_t map_size_;
 
   // Stats.
   size_t total_blocks_;
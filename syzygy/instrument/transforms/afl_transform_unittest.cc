@@ -52,6 +52,7 @@ class TestAFLTransform : public AFLTransform {
 
   using AFLTransform::afl_static_cov_data_;
   using AFLTransform::multithread_;
+  using AFLTransform::num_counters_;
   using AFLTransform::targets_visited_;
   using AFLTransform::tls_afl_prev_loc_displacement_;
   using AFLTransform::total_code_blocks_;
@@ -339,6 +340,35 @@ TEST_F(AFLTransformTest, ApplyTranformMultithread) {
   ASSERT_NO_FATAL_FAILURE(CheckBasicBlockInstrumentation(afl_mt));
 }
 
+TEST_F(AFLTransformTest, ApplyTranformEdgeIndexing) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+
+  TestAFLTransform afl({},     // targets
+                       false,  // whitelist_mode
+                       false,  // force_decompose
+                       true,   // multithread
+                       false   // cookie_check_hook
+                       );
+  afl.set_edge_indexing(true);
+  EXPECT_TRUE(afl.edge_indexing());
+
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &afl, policy_, &block_graph_, header_block_));
+
+  // Each instrumented basic block has a counter of its own, and the edges
+  // leaving the conditional branches get the others.
+  EXPECT_LT(afl.bb_ranges().size(), afl.num_counters_);
+
+  // The bitmap fits all the counters.
+  EXPECT_LE(afl.num_counters_, afl.map_size());
+  EXPECT_EQ(0U, afl.map_size() & (afl.map_size() - 1));
+  EXPECT_EQ(AFLTransform::kOffsetArea + afl.map_size(),
+            afl.afl_static_cov_data_->size());
+
+  // There is no previous location to keep track of.
+  EXPECT_EQ(0U, afl.tls_afl_prev_loc_displacement_);
+}
+
 TEST_F(AFLTransformTest, ApplyTranformWhitelist) {
   ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
 
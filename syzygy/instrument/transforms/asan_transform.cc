@@ -24,12 +24,14 @@
 #include "base/memory/scoped_vector.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
+#include "syzygy/block_graph/analysis/control_flow_analysis.h"
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/block_builder.h"
 #include "syzygy/block_graph/block_util.h"
 #include "syzygy/block_graph/typed_block.h"
 #include "syzygy/common/defs.h"
+#include "syzygy/core/disassembler_util.h"
 #include "syzygy/instrument/transforms/asan_intercepts.h"
 #include "syzygy/instrument/transforms/entry_thunk_transform.h"
 #include "syzygy/pe/pe_utils.h"
@@ -57,6 +59,7 @@ using block_graph::Instruction;
 using block_graph::Operand;
 using block_graph::TransformPolicyInterface;
 using block_graph::TypedBlock;
+using block_graph::analysis::ControlFlowAnalysis;
 using block_graph::analysis::LivenessAnalysis;
 using block_graph::analysis::MemoryAccessAnalysis;
 using assm::Register32;
@@ -278,6 +281,24 @@ bool DecodeMemoryAccess(const Instruction& instr,
   return true;
 }
 
+// Use @p bb_asm to inject a call to @p hook.
+void CallAsanHook(BasicBlockAssembler* bb_asm,
+                  BlockGraph::Reference* hook,
+                  BlockGraph::ImageFormat image_format) {
+  DCHECK(hook != NULL);
+
+  if (image_format == BlockGraph::PE_IMAGE) {
+    // In PE images the hooks are brought in as imports, so they are indirect
+    // references.
+    bb_asm->call(Operand(Displacement(hook->referenced(), hook->offset())));
+  } else {
+    DCHECK_EQ(BlockGraph::COFF_IMAGE, image_format);
+    // In COFF images the hooks are brought in as symbols, so they are direct
+    // references.
+    bb_asm->call(Immediate(hook->referenced(), hook->offset()));
+  }
+}
+
 // Use @p bb_asm to inject a hook to @p hook to instrument the access to the
 // address stored in the operand @p op.
 void InjectAsanHook(BasicBlockAssembler* bb_asm,
@@ -300,19 +321,102 @@ void InjectAsanHook(BasicBlockAssembler* bb_asm,
     bb_asm->lea(assm::edx, op);
   }
 
-  // Call the hook.
-  if (image_format == BlockGraph::PE_IMAGE) {
-    // In PE images the hooks are brought in as imports, so they are indirect
-    // references.
-    bb_asm->call(Operand(Displacement(hook->referenced(), hook->offset())));
-  } else {
-    DCHECK_EQ(BlockGraph::COFF_IMAGE, image_format);
-    // In COFF images the hooks are brought in as symbols, so they are direct
-    // references.
-    bb_asm->call(Immediate(hook->referenced(), hook->offset()));
+  CallAsanHook(bb_asm, hook, image_format);
+}
+
+// Use @p bb_asm to inject a hook to @p hook to instrument the accesses to the
+// range of @p length bytes at @p begin from the register @p base_reg.
+void InjectAsanRangeHook(BasicBlockAssembler* bb_asm,
+                         const Register32& base_reg,
+                         int32_t begin,
+                         uint32_t length,
+                         BlockGraph::Reference* hook,
+                         BlockGraph::ImageFormat image_format) {
+  DCHECK(hook != NULL);
+  DCHECK_NE(0U, length);
+
+  // The range probe expects the start of the range in EDX, and the length of
+  // the range on the stack, above the original value of EDX. It restores EDX
+  // and cleans up the stack.
+  bb_asm->push(assm::edx);
+  bb_asm->lea(assm::edx,
+              Operand(base_reg, Displacement(static_cast<uint32_t>(begin))));
+  bb_asm->push(Immediate(length));
+
+  CallAsanHook(bb_asm, hook, image_format);
+}
+
+// Collects the loops of the structural tree rooted at @p node, outer loops
+// first.
+void FindLoops(const ControlFlowAnalysis::StructuralNode* node,
+               std::vector<const ControlFlowAnalysis::StructuralNode*>* loops) {
+  DCHECK(node != NULL);
+  DCHECK(loops != NULL);
+
+  typedef ControlFlowAnalysis::StructuralNode StructuralNode;
+  switch (node->kind()) {
+    case StructuralNode::kBaseNode:
+      break;
+    case StructuralNode::kSequenceNode:
+      FindLoops(node->entry_node(), loops);
+      FindLoops(node->sequence_node(), loops);
+      break;
+    case StructuralNode::kIfThenNode:
+      FindLoops(node->entry_node(), loops);
+      FindLoops(node->then_node(), loops);
+      break;
+    case StructuralNode::kIfThenElseNode:
+      FindLoops(node->entry_node(), loops);
+      FindLoops(node->then_node(), loops);
+      FindLoops(node->else_node(), loops);
+      break;
+    case StructuralNode::kRepeatNode:
+    case StructuralNode::kLoopNode:
+      loops->push_back(node);
+      FindLoops(node->entry_node(), loops);
+      break;
+    case StructuralNode::kWhileNode:
+      loops->push_back(node);
+      FindLoops(node->entry_node(), loops);
+      FindLoops(node->body_node(), loops);
+      break;
+    default:
+      NOTREACHED() << "Invalid structural node.";
   }
 }
 
+// Checks whether the location accessed by @p instr through @p base_reg stays
+// the same across the iterations of a loop. This is the case when the base
+// register isn't modified anywhere in the loop, which must also contain no
+// calls, as these may change the state of the memory.
+// @param instr The instruction performing the access.
+// @param base_reg The base register of the access.
+// @param loop The basic blocks of the loop.
+// @returns true if the access is invariant in the loop, false otherwise.
+bool IsLoopInvariantAccess(
+    const Instruction& instr,
+    assm::RegisterId base_reg,
+    const std::set<const BasicCodeBlock*>& loop) {
+  int32_t displacement = static_cast<int32_t>(instr.representation().disp);
+
+  // The memory access analysis forgets an access as soon as its base register
+  // is modified, or on a call.
+  MemoryAccessAnalysis::State state;
+  MemoryAccessAnalysis::PropagateForward(instr, &state);
+  std::set<const BasicCodeBlock*>::const_iterator bb_iter = loop.begin();
+  for (; bb_iter != loop.end(); ++bb_iter) {
+    const BasicBlock::Instructions& instructions = (*bb_iter)->instructions();
+    BasicBlock::Instructions::const_iterator inst_iter = instructions.begin();
+    for (; inst_iter != instructions.end(); ++inst_iter) {
+      MemoryAccessAnalysis::PropagateForward(*inst_iter, &state);
+      if (!state.HasAccess(base_reg, displacement))
+        return false;
+    }
+  }
+
+  return true;
+}
+
 // Get the name of an asan check access function for an @p access_mode access.
 // @param info The memory access information, e.g. the size on a load/store,
 //     the instruction opcode and the kind of access.
@@ -320,6 +424,17 @@ std::string GetAsanCheckAccessFunctionName(
     AsanBasicBlockTransform::MemoryAccessInfo info,
     BlockGraph::ImageFormat image_format) {
   DCHECK(info.mode != AsanBasicBlockTransform::kNoAccess);
+
+  // For COFF images we use the decorated function name, which contains a
+  // leading underscore.
+  const char* prefix_str = image_format == BlockGraph::PE_IMAGE ? "" : "_";
+
+  // The range checks are independent of the size of the accesses.
+  if (info.mode == AsanBasicBlockTransform::kReadRangeAccess)
+    return base::StringPrintf("%sasan_check_range_read_access", prefix_str);
+  if (info.mode == AsanBasicBlockTransform::kWriteRangeAccess)
+    return base::StringPrintf("%sasan_check_range_write_access", prefix_str);
+
   DCHECK_NE(0U, info.size);
   DCHECK(info.mode == AsanBasicBlockTransform::kReadAccess ||
          info.mode == AsanBasicBlockTransform::kWriteAccess ||
@@ -341,11 +456,9 @@ std::string GetAsanCheckAccessFunctionName(
   else
     access_mode_str = reinterpret_cast<char*>(GET_MNEMONIC_NAME(info.opcode));
 
-  // For COFF images we use the decorated function name, which contains a
-  // leading underscore.
   std::string function_name =
       base::StringPrintf("%sasan_check%s_%d_byte_%s_access%s",
-                         image_format == BlockGraph::PE_IMAGE ? "" : "_",
+                         prefix_str,
                          rep_str,
                          info.size,
                          access_mode_str,
@@ -475,9 +588,9 @@ bool AddAsanCheckAccessHooks(
   return true;
 }
 
-// Create a stub for the asan_check_access functions. For load/store, the stub
-// consists of a small block of code that restores the value of EDX and returns
-// to the caller. Otherwise, the stub do return.
+// Create a stub for the asan_check_access functions. For load/store and range
+// checks, the stub consists of a small block of code that restores the value
+// of EDX and returns to the caller. Otherwise, the stub do return.
 // @param block_graph The block-graph to populate with the stub.
 // @param stub_name The stub's name.
 // @param mode The kind of memory access.
@@ -521,6 +634,12 @@ bool CreateHooksStub(BlockGraph* block_graph,
     // return.
     assm.mov(assm::edx, Operand(assm::esp, Displacement(4)));
     assm.ret(4);
+  } else if (mode == AsanBasicBlockTransform::kReadRangeAccess ||
+             mode == AsanBasicBlockTransform::kWriteRangeAccess) {
+    // The thunk body restores the original value of EDX and cleans the length
+    // of the range and EDX off the stack on return.
+    assm.mov(assm::edx, Operand(assm::esp, Displacement(8)));
+    assm.ret(8);
   } else {
     assm.ret();
   }
@@ -546,6 +665,7 @@ bool CreateHooksStub(BlockGraph* block_graph,
 // @param asan_hook_stub_name Name prefix of the stubs for the asan check access
 //     functions.
 // @param use_liveness_analysis true iff we use liveness analysis.
+// @param coalesce_adjacent_checks true iff we use the range check hooks.
 // @param import_module The module for which the import should be added.
 // @param check_access_hooks_ref The map where the reference to the imports
 //     should be stored.
@@ -557,6 +677,7 @@ bool CreateHooksStub(BlockGraph* block_graph,
 bool ImportAsanCheckAccessHooks(
     const char* asan_hook_stub_name,
     bool use_liveness_analysis,
+    bool coalesce_adjacent_checks,
     ImportedModule* import_module,
     AsanBasicBlockTransform::AsanHookMap* check_access_hooks_ref,
     const TransformPolicyInterface* policy,
@@ -594,6 +715,19 @@ bool ImportAsanCheckAccessHooks(
     default_stub_map[AsanBasicBlockTransform::kInstrAccess] = instr_hook;
     default_stub_map[AsanBasicBlockTransform::kRepzAccess] = instr_hook;
     default_stub_map[AsanBasicBlockTransform::kRepnzAccess] = instr_hook;
+
+    // Create the hook stub for range checks.
+    if (coalesce_adjacent_checks) {
+      BlockGraph::Reference range_hook;
+      if (!CreateHooksStub(block_graph, asan_hook_stub_name,
+                           AsanBasicBlockTransform::kReadRangeAccess,
+                           &range_hook)) {
+        return false;
+      }
+      default_stub_map[AsanBasicBlockTransform::kReadRangeAccess] = range_hook;
+      default_stub_map[AsanBasicBlockTransform::kWriteRangeAccess] =
+          range_hook;
+    }
   }
 
   // Import the hooks for the read/write accesses.
@@ -656,6 +790,18 @@ bool ImportAsanCheckAccessHooks(
     }
   }
 
+  // Import the hooks for the range checks. These are only imported on demand,
+  // as older runtimes don't provide them.
+  if (coalesce_adjacent_checks) {
+    MemoryAccessInfo read_range_info =
+        { AsanBasicBlockTransform::kReadRangeAccess, 0, 0, true };
+    access_hook_param_vec.push_back(read_range_info);
+
+    MemoryAccessInfo write_range_info =
+        { AsanBasicBlockTransform::kWriteRangeAccess, 0, 0, true };
+    access_hook_param_vec.push_back(write_range_info);
+  }
+
   if (!AddAsanCheckAccessHooks(access_hook_param_vec,
                                default_stub_map,
                                import_module,
@@ -1057,6 +1203,50 @@ bool PeGetRedirectsForStaticallyLinkedFunctions(
   return true;
 }
 
+// The column of the frequency data holding the basic block entry counts.
+const size_t kEntryCountColumn = 0;
+
+// A basic block of the profile, and the number of checks predicted to be
+// executed in it if it's fully instrumented.
+struct ProfiledBasicBlock {
+  core::RelativeAddress address;
+  grinder::basic_block_util::EntryCountType entry_count;
+  uint64_t check_count;
+};
+
+// Orders profiled basic blocks from the coldest to the hottest.
+bool ProfiledBasicBlockColder(const ProfiledBasicBlock& a,
+                              const ProfiledBasicBlock& b) {
+  return a.entry_count < b.entry_count;
+}
+
+// Counts the instrumentable memory accesses of a basic block of the original
+// image, by decoding @p block from @p offset up to the first instruction
+// transferring control flow other than a call.
+size_t CountMemoryAccesses(const BlockGraph::Block& block,
+                           BlockGraph::Offset offset) {
+  size_t access_count = 0;
+  while (offset >= 0 && static_cast<size_t>(offset) < block.data_size()) {
+    _DInst instr = {};
+    if (!core::DecodeOneInstruction(block.data() + offset,
+                                    block.data_size() - offset,
+                                    &instr)) {
+      break;
+    }
+
+    if (ShouldInstrumentOpcode(instr.opcode) &&
+        (IsInstrumentable(instr.ops[0]) || IsInstrumentable(instr.ops[1]))) {
+      ++access_count;
+    }
+
+    uint8_t flow_control = META_GET_FC(instr.meta);
+    if (flow_control != FC_NONE && flow_control != FC_CALL)
+      break;
+    offset += instr.size;
+  }
+  return access_count;
+}
+
 }  // namespace
 
 const char AsanBasicBlockTransform::kTransformName[] =
@@ -1068,7 +1258,8 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
     BlockGraph::ImageFormat image_format) {
   DCHECK_NE(reinterpret_cast<BasicCodeBlock*>(NULL), basic_block);
 
-  if (instrumentation_rate_ == 0.0)
+  double instrumentation_rate = GetInstrumentationRate(basic_block);
+  if (instrumentation_rate == 0.0)
     return true;
 
   // Pre-compute liveness information for each instruction.
@@ -1095,6 +1286,14 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
   if (remove_redundant_checks_)
     memory_accesses_.GetStateAtEntryOf(basic_block, &memory_state);
 
+  // When coalescing, the runs of adjacent accesses being accumulated, by base
+  // register and access mode. The base registers are tracked through their
+  // own memory access state, which only ever covers this basic block.
+  typedef std::pair<assm::RegisterId, MemoryAccessMode> AccessRunKey;
+  typedef std::map<AccessRunKey, AccessRun> AccessRunMap;
+  AccessRunMap runs;
+  MemoryAccessAnalysis::State run_state;
+
   // Process each instruction and inject a call to Asan when we find an
   // instrumentable memory access.
   BasicBlock::Instructions::iterator iter_inst =
@@ -1105,6 +1304,9 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
     const Instruction& instr = *iter_inst;
     const _DInst& repr = instr.representation();
 
+    if (coalesce_adjacent_checks_)
+      MemoryAccessAnalysis::PropagateForward(instr, &run_state);
+
     MemoryAccessInfo info;
     info.mode = kNoAccess;
     info.size = 0;
@@ -1179,21 +1381,11 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
       continue;
 
     // Randomly sample to effect partial instrumentation.
-    if (instrumentation_rate_ < 1.0 &&
-        base::RandDouble() >= instrumentation_rate_) {
+    if (instrumentation_rate < 1.0 &&
+        base::RandDouble() >= instrumentation_rate) {
       continue;
     }
 
-    // Create a BasicBlockAssembler to insert new instruction.
-    BasicBlockAssembler bb_asm(iter_inst, &basic_block->instructions());
-
-    // Configure the assembler to copy the SourceRange information of the
-    // current instrumented instruction into newly created instructions. This is
-    // a hack to allow valid stack walking and better error reporting, but
-    // breaks the 1:1 OMAP mapping and may confuse some debuggers.
-    if (debug_friendly_)
-      bb_asm.set_source_range(instr.source_range());
-
     if (use_liveness_analysis_ &&
         (info.mode == kReadAccess || info.mode == kWriteAccess)) {
       // Use the liveness information to skip saving the flags if possible.
@@ -1204,7 +1396,75 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
     // hook so we can call a dry run without hooks present.
     instrumentation_happened_ = true;
 
+    // The checks of the accesses that are invariant in their loop are done
+    // once, in the preheader of the loop.
+    if (hoist_loop_invariant_checks_) {
+      std::map<const Instruction*, BasicCodeBlock*>::const_iterator hoistable =
+          hoistable_checks_.find(&instr);
+      if (hoistable != hoistable_checks_.end()) {
+        if (!dry_run_) {
+          hoisted_checks_[hoistable->second].push_back(
+              HoistedCheck(info, operand, instr.source_range()));
+        }
+        continue;
+      }
+    }
+
+    // Accumulate the plain accesses through a base register in runs, which are
+    // checked once they can't be extended anymore. Accesses through ESP are
+    // left alone, as pushing the arguments of the range check moves ESP.
+    if (coalesce_adjacent_checks_ &&
+        (info.mode == kReadAccess || info.mode == kWriteAccess) &&
+        operand.base() != assm::kRegisterNone &&
+        operand.base() != assm::kRegisterEsp &&
+        operand.index() == assm::kRegisterNone) {
+      // The displacement of the operand is that of the last byte accessed.
+      int32_t begin = static_cast<int32_t>(operand.displacement().value()) -
+          static_cast<int32_t>(info.size - 1);
+      int32_t end = begin + static_cast<int32_t>(info.size);
+
+      // Extend the current run if the base register hasn't changed since its
+      // first access, and this access touches it.
+      AccessRunKey key(operand.base(), info.mode);
+      AccessRunMap::iterator run = runs.find(key);
+      if (run != runs.end() &&
+          run_state.HasAccess(operand.base(),
+                              run->second.first_displacement) &&
+          begin <= run->second.end && end >= run->second.begin) {
+        run->second.begin = std::min(run->second.begin, begin);
+        run->second.end = std::max(run->second.end, end);
+        ++run->second.access_count;
+        continue;
+      }
+
+      // Otherwise, check the current run and start a new one.
+      if (run != runs.end()) {
+        if (!InstrumentAccessRun(basic_block, run->second, image_format))
+          return false;
+        runs.erase(run);
+      }
+      AccessRun new_run(operand);
+      new_run.first_instruction = iter_inst;
+      new_run.first_info = info;
+      new_run.first_displacement = begin;
+      new_run.begin = begin;
+      new_run.end = end;
+      new_run.access_count = 1;
+      runs.insert(std::make_pair(key, new_run));
+      continue;
+    }
+
     if (!dry_run_) {
+      // Create a BasicBlockAssembler to insert new instruction.
+      BasicBlockAssembler bb_asm(iter_inst, &basic_block->instructions());
+
+      // Configure the assembler to copy the SourceRange information of the
+      // current instrumented instruction into newly created instructions. This
+      // is a hack to allow valid stack walking and better error reporting, but
+      // breaks the 1:1 OMAP mapping and may confuse some debuggers.
+      if (debug_friendly_)
+        bb_asm.set_source_range(instr.source_range());
+
       // Insert hook for standard instructions.
       AsanHookMap::iterator hook = check_access_hooks_->find(info);
       if (hook == check_access_hooks_->end()) {
@@ -1221,6 +1481,63 @@ bool AsanBasicBlockTransform::InstrumentBasicBlock(
 
   DCHECK(iter_state == states.end());
 
+  // Check the runs that are still open at the end of the basic block.
+  for (const auto& run : runs) {
+    if (!InstrumentAccessRun(basic_block, run.second, image_format))
+      return false;
+  }
+
+  return true;
+}
+
+bool AsanBasicBlockTransform::InstrumentAccessRun(
+    BasicCodeBlock* basic_block,
+    const AccessRun& run,
+    BlockGraph::ImageFormat image_format) {
+  DCHECK_NE(reinterpret_cast<BasicCodeBlock*>(NULL), basic_block);
+  DCHECK_NE(0U, run.access_count);
+  DCHECK_LT(run.begin, run.end);
+
+  if (dry_run_)
+    return true;
+
+  BasicBlockAssembler bb_asm(run.first_instruction,
+                             &basic_block->instructions());
+  if (debug_friendly_)
+    bb_asm.set_source_range(run.first_instruction->source_range());
+
+  // A run made of a single access is checked as usual.
+  if (run.access_count == 1) {
+    AsanHookMap::iterator hook = check_access_hooks_->find(run.first_info);
+    if (hook == check_access_hooks_->end()) {
+      LOG(ERROR) << "Invalid access : "
+                 << GetAsanCheckAccessFunctionName(run.first_info,
+                                                   image_format);
+      return false;
+    }
+
+    InjectAsanHook(&bb_asm, run.first_info, run.first_operand, &hook->second,
+                   LivenessAnalysis::State(), image_format);
+    return true;
+  }
+
+  MemoryAccessInfo info = { kReadRangeAccess, 0, 0, true };
+  if (run.first_info.mode == kWriteAccess)
+    info.mode = kWriteRangeAccess;
+
+  AsanHookMap::iterator hook = check_access_hooks_->find(info);
+  if (hook == check_access_hooks_->end()) {
+    LOG(ERROR) << "Invalid access : "
+               << GetAsanCheckAccessFunctionName(info, image_format);
+    return false;
+  }
+
+  const Register32& base_reg = assm::kRegisters32[
+      run.first_operand.base() - assm::kRegister32Min];
+  InjectAsanRangeHook(&bb_asm, base_reg, run.begin,
+                      static_cast<uint32_t>(run.end - run.begin),
+                      &hook->second, image_format);
+
   return true;
 }
 
@@ -1238,6 +1555,8 @@ bool AsanBasicBlockTransform::TransformBasicBlockSubGraph(
   DCHECK(block_graph != NULL);
   DCHECK(subgraph != NULL);
 
+  original_block_ = subgraph->original_block();
+
   // Perform a global liveness analysis.
   if (use_liveness_analysis_)
     liveness_.Analyze(subgraph);
@@ -1252,6 +1571,10 @@ bool AsanBasicBlockTransform::TransformBasicBlockSubGraph(
   if (!block_graph::HasUnexpectedStackFrameManipulation(subgraph))
     stack_mode = kSafeStackAccess;
 
+  // Find the checks that can be hoisted out of their loop.
+  if (hoist_loop_invariant_checks_)
+    FindHoistableChecks(subgraph);
+
   // Iterates through each basic block and instruments it.
   BasicBlockSubGraph::BBCollection::iterator it =
       subgraph->basic_blocks().begin();
@@ -1262,6 +1585,158 @@ bool AsanBasicBlockTransform::TransformBasicBlockSubGraph(
       return false;
     }
   }
+
+  // The preheaders are instrumented last, once all the hoisted checks are
+  // known.
+  if (!InstrumentPreheaders(block_graph->image_format()))
+    return false;
+
+  original_block_ = NULL;
+
+  return true;
+}
+
+double AsanBasicBlockTransform::GetInstrumentationRate(
+    const BasicCodeBlock* basic_block) const {
+  DCHECK_NE(reinterpret_cast<const BasicCodeBlock*>(NULL), basic_block);
+
+  // Basic blocks created by other transforms don't have a profile.
+  if (basic_block_rates_ == NULL || original_block_ == NULL ||
+      basic_block->offset() == BasicBlock::kNoOffset) {
+    return instrumentation_rate_;
+  }
+
+  BasicBlockRateMap::const_iterator it = basic_block_rates_->find(
+      original_block_->addr() + basic_block->offset());
+  if (it == basic_block_rates_->end())
+    return instrumentation_rate_;
+  return std::min(instrumentation_rate_, it->second);
+}
+
+void AsanBasicBlockTransform::FindHoistableChecks(
+    BasicBlockSubGraph* subgraph) {
+  DCHECK(subgraph != NULL);
+
+  hoistable_checks_.clear();
+
+  // Loops are only found in reducible subgraphs.
+  ControlFlowAnalysis::StructuralTree tree;
+  if (!ControlFlowAnalysis::BuildStructuralTree(subgraph, &tree))
+    return;
+  std::vector<const ControlFlowAnalysis::StructuralNode*> loops;
+  FindLoops(tree.get(), &loops);
+  if (loops.empty())
+    return;
+
+  // Find the predecessors of each basic block, and the basic blocks that may
+  // be entered from elsewhere.
+  std::map<const BasicBlock*, std::vector<BasicCodeBlock*>> predecessors;
+  BasicBlockSubGraph::BBCollection::iterator bb_iter =
+      subgraph->basic_blocks().begin();
+  for (; bb_iter != subgraph->basic_blocks().end(); ++bb_iter) {
+    BasicCodeBlock* bb = BasicCodeBlock::Cast(*bb_iter);
+    if (bb == NULL)
+      continue;
+    BasicBlock::Successors::const_iterator succ = bb->successors().begin();
+    for (; succ != bb->successors().end(); ++succ) {
+      if (succ->reference().basic_block() != NULL)
+        predecessors[succ->reference().basic_block()].push_back(bb);
+    }
+  }
+  std::set<const BasicBlock*> entries;
+  ControlFlowAnalysis::FindEntryBasicBlocks(subgraph, &entries);
+
+  for (size_t i = 0; i < loops.size(); ++i) {
+    const BasicCodeBlock* header = loops[i]->root();
+    if (entries.find(header) != entries.end())
+      continue;
+
+    std::set<const BasicCodeBlock*> loop;
+    loops[i]->GetBasicBlocks(&loop);
+
+    // The loop must be entered from a single preheader, whose only successor
+    // is the header of the loop. The hoisted checks are appended to it.
+    BasicCodeBlock* preheader = NULL;
+    bool has_preheader = true;
+    const std::vector<BasicCodeBlock*>& header_predecessors =
+        predecessors[header];
+    for (size_t j = 0; j < header_predecessors.size(); ++j) {
+      BasicCodeBlock* predecessor = header_predecessors[j];
+      if (loop.find(predecessor) != loop.end())
+        continue;
+      if (preheader != NULL || predecessor->successors().size() != 1) {
+        has_preheader = false;
+        break;
+      }
+      preheader = predecessor;
+    }
+    if (!has_preheader || preheader == NULL)
+      continue;
+
+    // The instructions of the header are executed on every iteration, and
+    // at least once when the loop is entered.
+    const BasicBlock::Instructions& instructions = header->instructions();
+    BasicBlock::Instructions::const_iterator inst_iter = instructions.begin();
+    for (; inst_iter != instructions.end(); ++inst_iter) {
+      auto operand(Operand(assm::eax));
+      MemoryAccessInfo info = { kNoAccess, 0, 0, true };
+      if (!DecodeMemoryAccess(*inst_iter, &operand, &info))
+        continue;
+
+      // Only plain accesses through a base register are hoisted. Accesses
+      // through ESP are left alone, as the checks move ESP.
+      if ((info.mode != kReadAccess && info.mode != kWriteAccess) ||
+          operand.base() == assm::kRegisterNone ||
+          operand.base() == assm::kRegisterEsp ||
+          operand.index() != assm::kRegisterNone) {
+        continue;
+      }
+
+      if (IsLoopInvariantAccess(*inst_iter, operand.base(), loop))
+        hoistable_checks_[&*inst_iter] = preheader;
+    }
+  }
+}
+
+bool AsanBasicBlockTransform::InstrumentPreheaders(
+    BlockGraph::ImageFormat image_format) {
+  std::map<BasicCodeBlock*, HoistedChecks>::iterator preheader =
+      hoisted_checks_.begin();
+  for (; preheader != hoisted_checks_.end(); ++preheader) {
+    BasicCodeBlock* bb = preheader->first;
+
+    // The checks are appended to the preheader, where the flags are live iff
+    // they are live at its exit.
+    bool save_flags = true;
+    LivenessAnalysis::State state;
+    if (use_liveness_analysis_) {
+      liveness_.GetStateAtExitOf(bb, &state);
+      save_flags = state.AreArithmeticFlagsLive();
+    }
+
+    BasicBlockAssembler bb_asm(bb->instructions().end(), &bb->instructions());
+    const HoistedChecks& checks = preheader->second;
+    for (size_t i = 0; i < checks.size(); ++i) {
+      MemoryAccessInfo info = checks[i].info;
+      info.save_flags = save_flags;
+
+      AsanHookMap::iterator hook = check_access_hooks_->find(info);
+      if (hook == check_access_hooks_->end()) {
+        LOG(ERROR) << "Invalid access : "
+                   << GetAsanCheckAccessFunctionName(info, image_format);
+        return false;
+      }
+
+      if (debug_friendly_)
+        bb_asm.set_source_range(checks[i].source_range);
+      InjectAsanHook(&bb_asm, info, checks[i].operand, &hook->second, state,
+                     image_format);
+    }
+  }
+
+  hoistable_checks_.clear();
+  hoisted_checks_.clear();
+
   return true;
 }
 
@@ -1313,10 +1788,16 @@ AsanTransform::AsanTransform()
     : debug_friendly_(false),
       use_liveness_analysis_(false),
       remove_redundant_checks_(false),
+      coalesce_adjacent_checks_(false),
+      hoist_loop_invariant_checks_(false),
       use_interceptors_(false),
       instrumentation_rate_(1.0),
+      instrumentation_profile_(nullptr),
+      check_budget_(0),
       asan_parameters_(nullptr),
       check_access_hooks_ref_(),
+      transform_cache_(nullptr),
+      use_transform_cache_(false),
       asan_parameters_block_(nullptr),
       hot_patching_(false) {
 }
@@ -1362,6 +1843,7 @@ bool AsanTransform::PreBlockGraphIteration(
   if (!hot_patching_) {
     if (!ImportAsanCheckAccessHooks(kAsanHookStubName,
                                     use_liveness_analysis(),
+                                    coalesce_adjacent_checks(),
                                     &import_module,
                                     &check_access_hooks_ref_,
                                     policy,
@@ -1386,6 +1868,12 @@ bool AsanTransform::PreBlockGraphIteration(
     }
   }
 
+  // Decide how densely to instrument the hot basic blocks.
+  if (instrumentation_profile_ != nullptr)
+    ComputeBasicBlockRates(policy, block_graph);
+
+  use_transform_cache_ = ConfigureTransformCache();
+
   return true;
 }
 
@@ -1404,10 +1892,20 @@ bool AsanTransform::OnBlock(const TransformPolicyInterface* policy,
   transform.set_debug_friendly(debug_friendly());
   transform.set_use_liveness_analysis(use_liveness_analysis());
   transform.set_remove_redundant_checks(remove_redundant_checks());
+  transform.set_coalesce_adjacent_checks(coalesce_adjacent_checks());
+  transform.set_hoist_loop_invariant_checks(hoist_loop_invariant_checks());
   transform.set_filter(filter());
+  transform.set_bitmap_filter(bitmap_filter());
   transform.set_instrumentation_rate(instrumentation_rate_);
+  if (instrumentation_profile_ != nullptr)
+    transform.set_basic_block_rates(&basic_block_rates_);
 
-  if (!hot_patching_) {
+  if (use_transform_cache_) {
+    if (!transform_cache_->ApplyTransform(
+            &transform, policy, block_graph, block)) {
+      return false;
+    }
+  } else if (!hot_patching_) {
     if (!ApplyBasicBlockSubGraphTransform(
             &transform, policy, block_graph, block, NULL)) {
       return false;
@@ -1443,6 +1941,11 @@ bool AsanTransform::PostBlockGraphIteration(
   DCHECK(block_graph != NULL);
   DCHECK(header_block != NULL);
 
+  if (use_transform_cache_) {
+    LOG(INFO) << "Transform cache hits: " << transform_cache_->hits()
+              << ", misses: " << transform_cache_->misses() << ".";
+  }
+
   if (block_graph->image_format() == BlockGraph::PE_IMAGE) {
     if (!PeInterceptFunctions(kAsanIntercepts, policy, block_graph,
                               header_block)) {
@@ -1524,6 +2027,42 @@ void AsanTransform::FindHeapInitAndCrtHeapBlocks(BlockGraph* block_graph) {
   }
 }
 
+bool AsanTransform::ConfigureTransformCache() {
+  if (transform_cache_ == nullptr)
+    return false;
+
+  // The outcome of these depends on more than the content of the block.
+  if (filter() != nullptr || instrumentation_rate_ < 1.0 ||
+      instrumentation_profile_ != nullptr || hot_patching_) {
+    LOG(WARNING) << "Not using the transform cache, as it doesn't support "
+                 << "filters, instrumentation rates, instrumentation "
+                 << "profiles or hot patching.";
+    return false;
+  }
+
+  // The configuration covers the options the basic-block transform depends
+  // on, and the layout of the hooks it refers to.
+  std::string configuration = base::StringPrintf(
+      "%s:%d:%d:%d:%d:%d", kTransformName, debug_friendly_,
+      use_liveness_analysis_, remove_redundant_checks_,
+      coalesce_adjacent_checks_, hoist_loop_invariant_checks_);
+  block_graph::BlockTransformCache::BlockVector external_blocks;
+  for (const auto& hook : check_access_hooks_ref_) {
+    const BlockGraph::Reference& ref = hook.second;
+    base::StringAppendF(&configuration, ";%d:%d:%d:%d:%s+%d:%d:%d",
+                        hook.first.mode, hook.first.size, hook.first.opcode,
+                        hook.first.save_flags, ref.referenced()->name().c_str(),
+                        ref.offset(), ref.base(), ref.type());
+    if (std::find(external_blocks.begin(), external_blocks.end(),
+                  ref.referenced()) == external_blocks.end()) {
+      external_blocks.push_back(ref.referenced());
+    }
+  }
+  transform_cache_->SetConfiguration(configuration, external_blocks);
+
+  return true;
+}
+
 bool AsanTransform::ShouldSkipBlock(const TransformPolicyInterface* policy,
                                     BlockGraph::Block* block) {
   // Heap initialization blocks and intercepted blocks must be skipped.
@@ -1541,6 +2080,67 @@ bool AsanTransform::ShouldSkipBlock(const TransformPolicyInterface* policy,
   return false;
 }
 
+void AsanTransform::ComputeBasicBlockRates(
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph) {
+  DCHECK_NE(static_cast<TransformPolicyInterface*>(nullptr), policy);
+  DCHECK_NE(static_cast<BlockGraph*>(nullptr), block_graph);
+  DCHECK_NE(static_cast<IndexedFrequencyMap*>(nullptr),
+            instrumentation_profile_);
+
+  basic_block_rates_.clear();
+
+  // Predict the number of checks executed in each profiled basic block.
+  std::vector<ProfiledBasicBlock> basic_blocks;
+  BlockGraph::BlockMap::iterator block_it =
+      block_graph->blocks_mutable().begin();
+  for (; block_it != block_graph->blocks_mutable().end(); ++block_it) {
+    BlockGraph::Block* block = &block_it->second;
+    if (block->type() != BlockGraph::CODE_BLOCK ||
+        ShouldSkipBlock(policy, block)) {
+      continue;
+    }
+
+    core::RelativeAddress end = block->addr() + block->size();
+    IndexedFrequencyMap::const_iterator freq =
+        instrumentation_profile_->lower_bound(
+            std::make_pair(block->addr(), kEntryCountColumn));
+    for (; freq != instrumentation_profile_->end() && freq->first.first < end;
+         ++freq) {
+      if (freq->first.second != kEntryCountColumn || freq->second <= 0)
+        continue;
+      size_t access_count =
+          CountMemoryAccesses(*block, freq->first.first - block->addr());
+      if (access_count == 0)
+        continue;
+      ProfiledBasicBlock basic_block = {
+          freq->first.first, freq->second,
+          static_cast<uint64_t>(freq->second) * access_count };
+      basic_blocks.push_back(basic_block);
+    }
+  }
+
+  // Spend the budget on the coldest basic blocks first.
+  std::stable_sort(basic_blocks.begin(), basic_blocks.end(),
+                   ProfiledBasicBlockColder);
+  uint64_t remaining_budget = check_budget_;
+  for (const ProfiledBasicBlock& basic_block : basic_blocks) {
+    if (basic_block.check_count <= remaining_budget) {
+      remaining_budget -= basic_block.check_count;
+      continue;
+    }
+    basic_block_rates_[basic_block.address] =
+        static_cast<double>(remaining_budget) / basic_block.check_count;
+    remaining_budget = 0;
+  }
+
+  if (!basic_block_rates_.empty()) {
+    LOG(INFO) << "Sampling " << basic_block_rates_.size() << " of "
+              << basic_blocks.size() << " profiled basic blocks to stay "
+              << "within a budget of " << check_budget_ << " checks.";
+  }
+}
+
 bool AsanTransform::PeFindStaticallyLinkedFunctionsToIntercept(
     const AsanIntercept* intercepts,
     BlockGraph* block_graph) {
@@ -1687,7 +2287,7 @@ bool AsanTransform::PeInjectAsanParameters(
   params_block->CopyData(fparams.data().size(), fparams.data().data());
 
   // Wire up any references that are required.
-  static_assert(15 == common::kAsanParametersVersion,
+  static_assert(28 == common::kAsanParametersVersion,
                 "Pointers in the params must be linked up here.");
   block_graph::TypedBlock<common::AsanParameters> params;
   CHECK(params.Init(0, params_block));
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "base/strings/string_piece.h"
+#include "syzygy/block_graph/block_transform_cache.h"
 #include "syzygy/block_graph/filterable.h"
 #include "syzygy/block_graph/iterate.h"
 #include "syzygy/block_graph/analysis/liveness_analysis.h"
@@ -31,6 +32,8 @@
 #include "syzygy/block_graph/transforms/iterative_transform.h"
 #include "syzygy/block_graph/transforms/named_transform.h"
 #include "syzygy/common/asan_parameters.h"
+#include "syzygy/core/address.h"
+#include "syzygy/grinder/basic_block_util.h"
 #include "syzygy/instrument/transforms/asan_interceptor_filter.h"
 #include "syzygy/instrument/transforms/asan_intercepts.h"
 #include "syzygy/pe/transforms/pe_add_imports_transform.h"
@@ -52,6 +55,10 @@ class AsanBasicBlockTransform
     kInstrAccess,
     kRepzAccess,
     kRepnzAccess,
+    // Range checks cover a run of read or write accesses to adjacent memory
+    // locations. These are only emitted when coalescing checks.
+    kReadRangeAccess,
+    kWriteRangeAccess,
   };
 
   enum StackAccessMode {
@@ -75,17 +82,24 @@ class AsanBasicBlockTransform
   // Map of hooks to Asan check access functions.
   typedef std::map<AsanHookMapEntryKey, BlockGraph::Reference> AsanHookMap;
   typedef std::map<MemoryAccessMode, BlockGraph::Reference> AsanDefaultHookMap;
+  // Map of the original addresses of basic blocks to the rate at which their
+  // accesses are instrumented.
+  typedef std::map<core::RelativeAddress, double> BasicBlockRateMap;
 
   // Constructor.
   // @param check_access_hooks References to the various check access functions.
   //     The hooks are assumed to be direct references for COFF images, and
   //     indirect references for PE images.
   explicit AsanBasicBlockTransform(AsanHookMap* check_access_hooks) :
+      basic_block_rates_(NULL),
       check_access_hooks_(check_access_hooks),
+      coalesce_adjacent_checks_(false),
       debug_friendly_(false),
       dry_run_(false),
+      hoist_loop_invariant_checks_(false),
       instrumentation_happened_(false),
       instrumentation_rate_(1.0),
+      original_block_(NULL),
       remove_redundant_checks_(false),
       use_liveness_analysis_(false) {
     DCHECK(check_access_hooks != NULL);
@@ -106,10 +120,32 @@ class AsanBasicBlockTransform
     remove_redundant_checks_ = remove_redundant_checks;
   }
 
+  bool coalesce_adjacent_checks() const { return coalesce_adjacent_checks_; }
+  void set_coalesce_adjacent_checks(bool coalesce_adjacent_checks) {
+    coalesce_adjacent_checks_ = coalesce_adjacent_checks;
+  }
+
+  bool hoist_loop_invariant_checks() const {
+    return hoist_loop_invariant_checks_;
+  }
+  void set_hoist_loop_invariant_checks(bool hoist_loop_invariant_checks) {
+    hoist_loop_invariant_checks_ = hoist_loop_invariant_checks;
+  }
+
   // The instrumentation rate must be in the range [0, 1], inclusive.
   double instrumentation_rate() const { return instrumentation_rate_; }
   void set_instrumentation_rate(double instrumentation_rate);
 
+  // The per basic block instrumentation rates, which override the
+  // instrumentation rate when lower. These are looked up by the original
+  // address of the basic blocks. May be NULL.
+  const BasicBlockRateMap* basic_block_rates() const {
+    return basic_block_rates_;
+  }
+  void set_basic_block_rates(const BasicBlockRateMap* basic_block_rates) {
+    basic_block_rates_ = basic_block_rates;
+  }
+
   // Instead of instrumenting the basic blocks, in dry run mode the instrumenter
   // only signals if any instrumentation would have happened on the block.
   // @returns true iff the instrumenter is in dry run mode.
@@ -150,6 +186,74 @@ class AsanBasicBlockTransform
                             StackAccessMode stack_mode,
                             BlockGraph::ImageFormat image_format);
 
+  // Returns the rate at which the accesses of a basic block are instrumented.
+  // @param basic_block The basic block, from the subgraph being transformed.
+  // @returns the lowest of the instrumentation rate and of the rate of
+  //     @p basic_block in the basic block rates, if any.
+  double GetInstrumentationRate(
+      const block_graph::BasicCodeBlock* basic_block) const;
+
+  // A run of read or write accesses to adjacent memory locations through the
+  // same base register, which can be covered by a single range check.
+  struct AccessRun {
+    explicit AccessRun(const block_graph::BasicBlockAssembler::Operand& op) :
+        first_operand(op), first_displacement(0), begin(0), end(0),
+        access_count(0) {
+    }
+
+    // The first instruction of the run. The check is injected before it.
+    block_graph::BasicBlock::Instructions::iterator first_instruction;
+    // The first access of the run, as it is checked when the run is made of
+    // a single access.
+    MemoryAccessInfo first_info;
+    block_graph::BasicBlockAssembler::Operand first_operand;
+    // The displacement of the first access, which is what the memory access
+    // analysis tracks to tell whether the base register is still unchanged.
+    int32_t first_displacement;
+    // The range covered by the run, relative to the base register.
+    int32_t begin;
+    int32_t end;
+    // The number of accesses in the run.
+    size_t access_count;
+  };
+
+  // Injects the check for a run of accesses, before its first instruction.
+  // @param basic_block The basic block containing the run.
+  // @param run The run to check.
+  // @param image_format The format of the image being instrumented.
+  // @returns true on success, false otherwise.
+  bool InstrumentAccessRun(block_graph::BasicCodeBlock* basic_block,
+                           const AccessRun& run,
+                           BlockGraph::ImageFormat image_format);
+
+  // A check of an access in the header of a loop, hoisted into the preheader
+  // of the loop.
+  struct HoistedCheck {
+    HoistedCheck(const MemoryAccessInfo& info,
+                 const block_graph::BasicBlockAssembler::Operand& operand,
+                 const block_graph::Instruction::SourceRange& source_range)
+        : info(info), operand(operand), source_range(source_range) {
+    }
+
+    MemoryAccessInfo info;
+    block_graph::BasicBlockAssembler::Operand operand;
+    // The source range of the instruction performing the access.
+    block_graph::Instruction::SourceRange source_range;
+  };
+  typedef std::vector<HoistedCheck> HoistedChecks;
+
+  // Finds the accesses of @p subgraph whose check may be hoisted out of their
+  // loop. These are the accesses in the header of a loop through a base
+  // register that isn't modified anywhere in the loop, when the loop contains
+  // no calls and has a preheader.
+  // @param subgraph The subgraph to analyze.
+  void FindHoistableChecks(BasicBlockSubGraph* subgraph);
+
+  // Injects the hoisted checks at the end of their preheader.
+  // @param image_format The format of the image being instrumented.
+  // @returns true on success, false otherwise.
+  bool InstrumentPreheaders(BlockGraph::ImageFormat image_format);
+
  private:
   // Liveness analysis and liveness information for this subgraph.
   block_graph::analysis::LivenessAnalysis liveness_;
@@ -157,9 +261,16 @@ class AsanBasicBlockTransform
   // Memory accesses value numbering.
   block_graph::analysis::MemoryAccessAnalysis memory_accesses_;
 
+  // The per basic block instrumentation rates. May be NULL.
+  const BasicBlockRateMap* basic_block_rates_;
+
   // The references to the Asan access check import entries.
   AsanHookMap* check_access_hooks_;
 
+  // When activated, runs of accesses to adjacent memory locations through the
+  // same base register are checked with a single range check.
+  bool coalesce_adjacent_checks_;
+
   // Activate the overwriting of source range for created instructions.
   bool debug_friendly_;
 
@@ -167,6 +278,19 @@ class AsanBasicBlockTransform
   // signal whether there would be an instrumentation in the block.
   bool dry_run_;
 
+  // When activated, the checks of the accesses that are invariant in a loop
+  // are hoisted into the preheader of the loop.
+  bool hoist_loop_invariant_checks_;
+
+  // The instructions whose check may be hoisted, and the preheader of their
+  // loop. Only valid while transforming a subgraph.
+  std::map<const block_graph::Instruction*, block_graph::BasicCodeBlock*>
+      hoistable_checks_;
+
+  // The checks hoisted into each preheader. Only valid while transforming a
+  // subgraph.
+  std::map<block_graph::BasicCodeBlock*, HoistedChecks> hoisted_checks_;
+
   // Controls the rate at which reads/writes are instrumented. This is
   // implemented using random sampling.
   double instrumentation_rate_;
@@ -175,6 +299,10 @@ class AsanBasicBlockTransform
   // during a dry run transform, this member is set to true.
   bool instrumentation_happened_;
 
+  // The block from which the subgraph being transformed was decomposed, if
+  // any. This locates its basic blocks in the basic block rates.
+  const BlockGraph::Block* original_block_;
+
   // When activated, a redundancy elimination is performed to minimize the
   // memory checks added by this transform.
   bool remove_redundant_checks_;
@@ -234,6 +362,7 @@ class AsanTransform
   typedef block_graph::TransformPolicyInterface TransformPolicyInterface;
   typedef AsanBasicBlockTransform::MemoryAccessMode MemoryAccessMode;
   typedef std::set<BlockGraph::Block*, BlockGraph::BlockIdLess> BlockSet;
+  typedef grinder::basic_block_util::IndexedFrequencyMap IndexedFrequencyMap;
 
   // Initialize a new AsanTransform instance.
   AsanTransform();
@@ -283,10 +412,40 @@ class AsanTransform
     remove_redundant_checks_ = remove_redundant_checks;
   }
 
+  // Coalescing the checks of adjacent accesses uses the range check hooks,
+  // which older runtimes don't export. This is thus off by default.
+  bool coalesce_adjacent_checks() const { return coalesce_adjacent_checks_; }
+  void set_coalesce_adjacent_checks(bool coalesce_adjacent_checks) {
+    coalesce_adjacent_checks_ = coalesce_adjacent_checks;
+  }
+
+  bool hoist_loop_invariant_checks() const {
+    return hoist_loop_invariant_checks_;
+  }
+  void set_hoist_loop_invariant_checks(bool hoist_loop_invariant_checks) {
+    hoist_loop_invariant_checks_ = hoist_loop_invariant_checks;
+  }
+
   // The instrumentation rate must be in the range [0, 1], inclusive.
   double instrumentation_rate() const { return instrumentation_rate_; }
   void set_instrumentation_rate(double instrumentation_rate);
 
+  // The basic block entry counts of a profile of the image. When set, the
+  // hottest basic blocks are sampled or left uninstrumented so that the number
+  // of checks predicted to be executed in the profiled run stays within the
+  // check budget. The profile must outlive the transform.
+  const IndexedFrequencyMap* instrumentation_profile() const {
+    return instrumentation_profile_;
+  }
+  void set_instrumentation_profile(const IndexedFrequencyMap* profile) {
+    instrumentation_profile_ = profile;
+  }
+
+  // The number of checks the instrumentation may execute, as predicted by the
+  // instrumentation profile. Only used along with a profile.
+  uint64_t check_budget() const { return check_budget_; }
+  void set_check_budget(uint64_t check_budget) { check_budget_ = check_budget; }
+
   // Asan RTL parameters.
   const common::InflatedAsanParameters* asan_parameters() const {
     return asan_parameters_;
@@ -295,6 +454,16 @@ class AsanTransform
       const common::InflatedAsanParameters* asan_parameters) {
     asan_parameters_ = asan_parameters;
   }
+
+  // The cache of the outcomes of the basic-block transform. The cache may be
+  // NULL, and is not used in the configurations whose outcome isn't only a
+  // function of the transformed block.
+  block_graph::BlockTransformCache* transform_cache() const {
+    return transform_cache_;
+  }
+  void set_transform_cache(block_graph::BlockTransformCache* transform_cache) {
+    transform_cache_ = transform_cache;
+  }
   // @}
 
   // Checks if the transform is in hot patching mode.
@@ -346,6 +515,24 @@ class AsanTransform
   bool ShouldSkipBlock(const TransformPolicyInterface* policy,
                        BlockGraph::Block* block);
 
+  // Sets up the transform cache for the current block graph, if there is a
+  // cache and the configuration of the transform allows it. Called at the end
+  // of PreBlockGraphIteration, once the hooks are imported.
+  // @returns true iff the transform cache should be used.
+  bool ConfigureTransformCache();
+
+  // Computes the basic block rates from the instrumentation profile. The
+  // profiled basic blocks are fully instrumented from the coldest up, until
+  // the check budget runs out. The basic block at which this happens is
+  // sampled to use up what remains of the budget, and the hotter ones aren't
+  // instrumented at all.
+  // @param policy The policy object that tells if a block is safe to
+  //     BB-decompose.
+  // @param block_graph The block graph being instrumented.
+  // @pre instrumentation_profile_ must not be NULL.
+  void ComputeBasicBlockRates(const TransformPolicyInterface* policy,
+                              BlockGraph* block_graph);
+
   // @name PE-specific methods.
   // @{
   // Finds statically linked functions that need to be intercepted. Called in
@@ -398,6 +585,14 @@ class AsanTransform
   // memory checks added by this transform.
   bool remove_redundant_checks_;
 
+  // When activated, runs of accesses to adjacent memory locations are checked
+  // with a single range check.
+  bool coalesce_adjacent_checks_;
+
+  // When activated, the checks of the accesses that are invariant in a loop
+  // are hoisted out of the loop.
+  bool hoist_loop_invariant_checks_;
+
   // Set iff we should use the functions interceptors.
   bool use_interceptors_;
 
@@ -405,6 +600,15 @@ class AsanTransform
   // implemented using random sampling.
   double instrumentation_rate_;
 
+  // The profile guiding the instrumentation density, and the number of checks
+  // it allows to execute. The profile may be NULL.
+  const IndexedFrequencyMap* instrumentation_profile_;
+  uint64_t check_budget_;
+
+  // The instrumentation rates of the hot basic blocks, as computed from the
+  // instrumentation profile. Valid after a successful PreBlockGraphIteration.
+  AsanBasicBlockTransform::BasicBlockRateMap basic_block_rates_;
+
   // Asan RTL parameters that will be injected into the instrumented image.
   // These will be found by the RTL and used to control its behaviour. Allows
   // for setting parameters at instrumentation time that vary from the defaults.
@@ -416,6 +620,11 @@ class AsanTransform
   // successful PreBlockGraphIteration.
   AsanBasicBlockTransform::AsanHookMap check_access_hooks_ref_;
 
+  // The cache of the outcomes of the basic-block transform, and whether it's
+  // used for the current block graph. The cache may be NULL.
+  block_graph::BlockTransformCache* transform_cache_;
+  bool use_transform_cache_;
+
   // Block containing any injected runtime parameters. Valid in PE mode after
   // a successful PostBlockGraphIteration. This is a unittesting seam.
   block_graph::BlockGraph::Block* asan_parameters_block_;
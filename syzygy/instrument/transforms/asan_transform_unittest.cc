@@ -80,12 +80,14 @@ class TestAsanInterceptorFilter : public AsanInterceptorFilter {
 class TestAsanTransform : public AsanTransform {
  public:
   using AsanTransform::asan_parameters_block_;
+  using AsanTransform::basic_block_rates_;
   using AsanTransform::heap_init_blocks_;
   using AsanTransform::hot_patched_blocks_;
   using AsanTransform::static_intercepted_blocks_;
   using AsanTransform::use_interceptors_;
   using AsanTransform::use_liveness_analysis_;
   using AsanTransform::CoffInterceptFunctions;
+  using AsanTransform::ComputeBasicBlockRates;
   using AsanTransform::FindHeapInitAndCrtHeapBlocks;
   using AsanTransform::ShouldSkipBlock;
   using AsanTransform::PeFindStaticallyLinkedFunctionsToIntercept;
@@ -169,6 +171,12 @@ class AsanTransformTest : public testing::TestDllTransformTest {
                  false);
     }
 
+    // Initialize the range access hooks.
+    AddHookRef("asan_check_range_read_access",
+               AsanBasicBlockTransform::kReadRangeAccess, 0, 0, true);
+    AddHookRef("asan_check_range_write_access",
+               AsanBasicBlockTransform::kWriteRangeAccess, 0, 0, true);
+
     const _InstructionType strings[] = {I_CMPS, I_LODS, I_MOVS, I_STOS};
     int strings_length = arraysize(strings);
 
@@ -317,6 +325,23 @@ TEST_F(AsanTransformTest, SetInstrumentationRate) {
   EXPECT_EQ(0.5, bb_transform.instrumentation_rate());
 }
 
+TEST_F(AsanTransformTest, SetInstrumentationProfile) {
+  AsanTransform::IndexedFrequencyMap profile;
+  EXPECT_EQ(nullptr, asan_transform_.instrumentation_profile());
+  asan_transform_.set_instrumentation_profile(&profile);
+  EXPECT_EQ(&profile, asan_transform_.instrumentation_profile());
+
+  EXPECT_EQ(0U, asan_transform_.check_budget());
+  asan_transform_.set_check_budget(42);
+  EXPECT_EQ(42U, asan_transform_.check_budget());
+
+  AsanBasicBlockTransform::BasicBlockRateMap rates;
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  EXPECT_EQ(nullptr, bb_transform.basic_block_rates());
+  bb_transform.set_basic_block_rates(&rates);
+  EXPECT_EQ(&rates, bb_transform.basic_block_rates());
+}
+
 TEST_F(AsanTransformTest, SetInterceptCRTFuntionsFlag) {
   EXPECT_FALSE(asan_transform_.use_interceptors());
   asan_transform_.set_use_interceptors(true);
@@ -325,6 +350,36 @@ TEST_F(AsanTransformTest, SetInterceptCRTFuntionsFlag) {
   EXPECT_FALSE(asan_transform_.use_interceptors());
 }
 
+TEST_F(AsanTransformTest, SetCoalesceAdjacentChecksFlag) {
+  EXPECT_FALSE(asan_transform_.coalesce_adjacent_checks());
+  asan_transform_.set_coalesce_adjacent_checks(true);
+  EXPECT_TRUE(asan_transform_.coalesce_adjacent_checks());
+  asan_transform_.set_coalesce_adjacent_checks(false);
+  EXPECT_FALSE(asan_transform_.coalesce_adjacent_checks());
+
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  EXPECT_FALSE(bb_transform.coalesce_adjacent_checks());
+  bb_transform.set_coalesce_adjacent_checks(true);
+  EXPECT_TRUE(bb_transform.coalesce_adjacent_checks());
+  bb_transform.set_coalesce_adjacent_checks(false);
+  EXPECT_FALSE(bb_transform.coalesce_adjacent_checks());
+}
+
+TEST_F(AsanTransformTest, SetHoistLoopInvariantChecksFlag) {
+  EXPECT_FALSE(asan_transform_.hoist_loop_invariant_checks());
+  asan_transform_.set_hoist_loop_invariant_checks(true);
+  EXPECT_TRUE(asan_transform_.hoist_loop_invariant_checks());
+  asan_transform_.set_hoist_loop_invariant_checks(false);
+  EXPECT_FALSE(asan_transform_.hoist_loop_invariant_checks());
+
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  EXPECT_FALSE(bb_transform.hoist_loop_invariant_checks());
+  bb_transform.set_hoist_loop_invariant_checks(true);
+  EXPECT_TRUE(bb_transform.hoist_loop_invariant_checks());
+  bb_transform.set_hoist_loop_invariant_checks(false);
+  EXPECT_FALSE(bb_transform.hoist_loop_invariant_checks());
+}
+
 TEST_F(AsanTransformTest, SetRemoveRedundantChecksFlag) {
   EXPECT_FALSE(asan_transform_.remove_redundant_checks());
   asan_transform_.set_remove_redundant_checks(true);
@@ -371,6 +426,34 @@ TEST_F(AsanTransformTest, ApplyAsanTransformCoff) {
       &asan_transform_, policy_, &block_graph_, header_block_));
 }
 
+TEST_F(AsanTransformTest, ApplyAsanTransformWithTransformCache) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+
+  block_graph::BlockTransformCache cache;
+  asan_transform_.set_transform_cache(&cache);
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &asan_transform_, policy_, &block_graph_, header_block_));
+
+  // The blocks are transformed via the cache.
+  EXPECT_FALSE(cache.configuration().empty());
+  EXPECT_LT(0u, cache.misses());
+  EXPECT_LT(0u, cache.size());
+}
+
+TEST_F(AsanTransformTest, TransformCacheIsBypassedWithSampling) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+
+  block_graph::BlockTransformCache cache;
+  asan_transform_.set_transform_cache(&cache);
+  asan_transform_.set_instrumentation_rate(0.5);
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &asan_transform_, policy_, &block_graph_, header_block_));
+
+  EXPECT_EQ(0u, cache.hits());
+  EXPECT_EQ(0u, cache.misses());
+  EXPECT_EQ(0u, cache.size());
+}
+
 TEST_F(AsanTransformTest, NopsNotInstrumented) {
   // Add all of the nops to the block.
   static const size_t kMaxNopSize =
@@ -634,6 +717,198 @@ TEST_F(AsanTransformTest, InstrumentAndRemoveRedundantChecks) {
   ASSERT_EQ(basic_block_->instructions().size(), expected_instructions_count);
 }
 
+TEST_F(AsanTransformTest, InstrumentAndCoalesceAdjacentChecks) {
+  // Three adjacent reads through ECX, which form a single run.
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::ecx));
+  bb_asm_->mov(assm::ebx, block_graph::Operand(assm::ecx,
+                                               block_graph::Displacement(4)));
+  bb_asm_->mov(assm::edx, block_graph::Operand(assm::ecx,
+                                               block_graph::Displacement(8)));
+  // This read is adjacent too, but redefines ECX and starts a new run.
+  bb_asm_->mov(assm::ecx, block_graph::Operand(assm::ecx,
+                                               block_graph::Displacement(12)));
+  // A write through another register.
+  bb_asm_->mov(block_graph::Operand(assm::esi), assm::eax);
+
+  // Instrument this basic block.
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_coalesce_adjacent_checks(true);
+  ASSERT_TRUE(bb_transform.InstrumentBasicBlock(
+      basic_block_,
+      AsanBasicBlockTransform::kSafeStackAccess,
+      BlockGraph::PE_IMAGE));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+
+  // We had 5 instructions initially. The run gets a range check of 4
+  // instructions, and the two other accesses get 3 instructions each.
+  ASSERT_EQ(15U, basic_block_->instructions().size());
+
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+
+  // The run is checked by a single range check covering [ECX, ECX + 12).
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  HookMapEntryKey check_read_range_key =
+      { AsanBasicBlockTransform::kReadRangeAccess, 0, 0, true };
+  ASSERT_EQ(hooks_check_access_[check_read_range_key],
+      iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+
+  // The access redefining ECX gets a standard check.
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  HookMapEntryKey check_4_byte_read_key =
+      { AsanBasicBlockTransform::kReadAccess, 4, 0, true };
+  ASSERT_EQ(hooks_check_access_[check_4_byte_read_key],
+      iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+
+  // So does the write.
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  HookMapEntryKey check_4_byte_write_key =
+      { AsanBasicBlockTransform::kWriteAccess, 4, 0, true };
+  ASSERT_EQ(hooks_check_access_[check_4_byte_write_key],
+      iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+
+  ASSERT_TRUE(iter_inst == basic_block_->instructions().end());
+}
+
+TEST_F(AsanTransformTest, HoistLoopInvariantChecks) {
+  // The dummy basic block is the preheader of a loop, which exits to a basic
+  // block returning.
+  BasicCodeBlock* loop = subgraph_.AddBasicCodeBlock("loop");
+  BasicCodeBlock* exit = subgraph_.AddBasicCodeBlock("exit");
+  subgraph_.block_descriptions().front().basic_block_order.push_back(loop);
+  subgraph_.block_descriptions().front().basic_block_order.push_back(exit);
+  basic_block_->successors().push_back(
+      block_graph::Successor(block_graph::Successor::kConditionTrue,
+                             BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                                 4, loop),
+                             0));
+  loop->successors().push_back(
+      block_graph::Successor(block_graph::Successor::kConditionNotEqual,
+                             BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                                 4, loop),
+                             0));
+  loop->successors().push_back(
+      block_graph::Successor(block_graph::Successor::kConditionEqual,
+                             BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                                 4, exit),
+                             0));
+
+  // ESI is invariant in the loop, but EDI isn't.
+  block_graph::BasicBlockAssembler loop_asm(loop->instructions().end(),
+                                            &loop->instructions());
+  loop_asm.mov(assm::eax, block_graph::Operand(assm::esi));
+  loop_asm.mov(assm::ebx, block_graph::Operand(assm::edi));
+  loop_asm.lea(assm::edi, block_graph::Operand(assm::edi,
+                                               block_graph::Displacement(4)));
+  block_graph::BasicBlockAssembler exit_asm(exit->instructions().end(),
+                                            &exit->instructions());
+  exit_asm.ret();
+
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_hoist_loop_invariant_checks(true);
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+  EXPECT_TRUE(bb_transform.instrumentation_happened());
+
+  // The check of the access through ESI is done once, in the preheader.
+  ASSERT_EQ(3U, basic_block_->instructions().size());
+  BasicBlock::Instructions::const_iterator iter_inst =
+      basic_block_->instructions().begin();
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  HookMapEntryKey check_4_byte_read_key =
+      { AsanBasicBlockTransform::kReadAccess, 4, 0, true };
+  ASSERT_EQ(hooks_check_access_[check_4_byte_read_key],
+      iter_inst->references().begin()->second.block());
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+
+  // The access through EDI is still checked in the loop.
+  ASSERT_EQ(6U, loop->instructions().size());
+  iter_inst = loop->instructions().begin();
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_PUSH, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_CALL, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_MOV, (iter_inst++)->representation().opcode);
+  ASSERT_EQ(I_LEA, (iter_inst++)->representation().opcode);
+}
+
+TEST_F(AsanTransformTest, LoopChecksWithCallsAreNotHoisted) {
+  BasicCodeBlock* loop = subgraph_.AddBasicCodeBlock("loop");
+  BasicCodeBlock* exit = subgraph_.AddBasicCodeBlock("exit");
+  subgraph_.block_descriptions().front().basic_block_order.push_back(loop);
+  subgraph_.block_descriptions().front().basic_block_order.push_back(exit);
+  basic_block_->successors().push_back(
+      block_graph::Successor(block_graph::Successor::kConditionTrue,
+                             BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                                 4, loop),
+                             0));
+  loop->successors().push_back(
+      block_graph::Successor(block_graph::Successor::kConditionNotEqual,
+                             BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                                 4, loop),
+                             0));
+  loop->successors().push_back(
+      block_graph::Successor(block_graph::Successor::kConditionEqual,
+                             BasicBlockReference(BlockGraph::RELATIVE_REF,
+                                                 4, exit),
+                             0));
+
+  // The call may free the memory accessed through ESI.
+  block_graph::BasicBlockAssembler loop_asm(loop->instructions().end(),
+                                            &loop->instructions());
+  loop_asm.mov(assm::eax, block_graph::Operand(assm::esi));
+  loop_asm.call(block_graph::Immediate(0x12345678, assm::kSize32Bit));
+  block_graph::BasicBlockAssembler exit_asm(exit->instructions().end(),
+                                            &exit->instructions());
+  exit_asm.ret();
+
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_hoist_loop_invariant_checks(true);
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+
+  EXPECT_TRUE(basic_block_->instructions().empty());
+  EXPECT_EQ(5U, loop->instructions().size());
+}
+
+TEST_F(AsanTransformTest, BasicBlockRatesSkipHotBasicBlocks) {
+  BlockGraph::Block* block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 0x20, "hot");
+  block->set_addr(core::RelativeAddress(0x1000));
+  subgraph_.set_original_block(block);
+  basic_block_->set_offset(0x10);
+
+  bb_asm_->mov(assm::eax, block_graph::Operand(assm::esi));
+
+  AsanBasicBlockTransform::BasicBlockRateMap rates;
+  rates[core::RelativeAddress(0x1010)] = 0.0;
+  InitHooksRefs();
+  TestAsanBasicBlockTransform bb_transform(&hooks_check_access_ref_);
+  bb_transform.set_basic_block_rates(&rates);
+  ASSERT_TRUE(bb_transform.TransformBasicBlockSubGraph(
+      &pe_policy_, &block_graph_, &subgraph_));
+
+  // The hot basic block isn't instrumented.
+  EXPECT_FALSE(bb_transform.instrumentation_happened());
+  EXPECT_EQ(1U, basic_block_->instructions().size());
+}
+
 TEST_F(AsanTransformTest, NonInstrumentableStackBasedInstructions) {
   // DEC DWORD [EBP - 0x2830]
   static const uint8_t kDec1[6] = {0xff, 0x8d, 0xd0, 0xd7, 0xff, 0xff};
@@ -1803,6 +2078,51 @@ TEST_F(AsanTransformTest, ShouldSkipBlock) {
   EXPECT_TRUE(asan_transform_.ShouldSkipBlock(&policy, b2));
 }
 
+TEST_F(AsanTransformTest, ComputeBasicBlockRates) {
+  testing::DummyTransformPolicy policy;
+  BlockGraph block_graph;
+
+  // mov eax, [esi]; mov ebx, [edi]; ret.
+  static const uint8_t kColdCode[] = { 0x8B, 0x06, 0x8B, 0x1F, 0xC3 };
+  // mov eax, [esi]; ret; mov ebx, [edi]; ret.
+  static const uint8_t kHotCode[] = { 0x8B, 0x06, 0xC3, 0x8B, 0x1F, 0xC3 };
+
+  BlockGraph::Block* cold = block_graph.AddBlock(
+      BlockGraph::CODE_BLOCK, sizeof(kColdCode), "cold");
+  cold->SetData(kColdCode, sizeof(kColdCode));
+  cold->set_addr(core::RelativeAddress(0x1000));
+  BlockGraph::Block* hot = block_graph.AddBlock(
+      BlockGraph::CODE_BLOCK, sizeof(kHotCode), "hot");
+  hot->SetData(kHotCode, sizeof(kHotCode));
+  hot->set_addr(core::RelativeAddress(0x2000));
+
+  // The cold basic block executes 20 checks, the first hot basic block 1000
+  // and the second 2000.
+  AsanTransform::IndexedFrequencyMap profile;
+  profile[std::make_pair(core::RelativeAddress(0x1000), 0)] = 10;
+  profile[std::make_pair(core::RelativeAddress(0x2000), 0)] = 1000;
+  profile[std::make_pair(core::RelativeAddress(0x2003), 0)] = 2000;
+
+  asan_transform_.set_instrumentation_profile(&profile);
+  asan_transform_.set_check_budget(520);
+  asan_transform_.ComputeBasicBlockRates(&policy, &block_graph);
+
+  // The cold basic block is fully instrumented, the budget left is spent on
+  // the first hot basic block, and the hottest isn't instrumented.
+  ASSERT_EQ(2U, asan_transform_.basic_block_rates_.size());
+  EXPECT_EQ(0U, asan_transform_.basic_block_rates_.count(
+      core::RelativeAddress(0x1000)));
+  EXPECT_EQ(0.5, asan_transform_.basic_block_rates_[
+      core::RelativeAddress(0x2000)]);
+  EXPECT_EQ(0.0, asan_transform_.basic_block_rates_[
+      core::RelativeAddress(0x2003)]);
+
+  // A large enough budget instruments everything.
+  asan_transform_.set_check_budget(3020);
+  asan_transform_.ComputeBasicBlockRates(&policy, &block_graph);
+  EXPECT_TRUE(asan_transform_.basic_block_rates_.empty());
+}
+
 TEST_F(AsanTransformTest, PatchCRTHeapInitialization) {
   ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
 
@@ -23,6 +23,7 @@
 #include "syzygy/block_graph/block_util.h"
 #include "syzygy/common/defs.h"
 #include "syzygy/common/indexed_frequency_data.h"
+#include "syzygy/instrument/transforms/add_implicit_tls_transform.h"
 #include "syzygy/instrument/transforms/entry_thunk_transform.h"
 #include "syzygy/pe/pe_utils.h"
 #include "syzygy/pe/transforms/pe_add_imports_transform.h"
@@ -52,6 +53,11 @@ typedef pe::transforms::ImportedModule ImportedModule;
 
 const char kDefaultModuleName[] = "basic_block_entry_client.dll";
 const char kBasicBlockEnter[] = "_increment_indexed_freq_data";
+const char kFastPathThunkName[] = "_increment_indexed_freq_data_fast_path";
+
+// 0:000> dt ntdll!_TEB ThreadLocalStoragePointer
+//   +0x02c ThreadLocalStoragePointer : Ptr32 Void
+const size_t kOffsetTebStorage = 0x2C;
 
 // Compares two relative address ranges to see if they overlap. Assumes they
 // are already sorted. This is used to validate basic-block ranges.
@@ -125,6 +131,8 @@ BasicBlockEntryHookTransform::BasicBlockEntryHookTransform()
                         common::kBasicBlockFrequencyDataVersion,
                         common::IndexedFrequencyData::BASIC_BLOCK_ENTRY,
                         sizeof(ThreadLocalIndexedFrequencyData)),
+    fast_path_block_(NULL),
+    inline_tls_offset_(0),
     thunk_section_(NULL),
     instrument_dll_name_(kDefaultModuleName),
     set_src_ranges_for_thunks_(false),
@@ -161,6 +169,23 @@ bool BasicBlockEntryHookTransform::PreBlockGraphIteration(
                                                  pe::kCodeCharacteristics);
   DCHECK(thunk_section_ != NULL);
 
+  if (set_inline_fast_path_) {
+    // The loader stores the index of the implicit TLS slot holding the
+    // per-thread counters directly in the frequency data.
+    AddImplicitTlsTransform add_implicit_tls(
+        add_frequency_data_.frequency_data_block(),
+        offsetof(ThreadLocalIndexedFrequencyData, inline_tls_index));
+    if (!ApplyBlockGraphTransform(
+            &add_implicit_tls, policy, block_graph, header_block)) {
+      LOG(ERROR) << "Failed to add the inline counters TLS slot.";
+      return false;
+    }
+    inline_tls_offset_ = add_implicit_tls.tls_displacement();
+
+    if (!CreateBasicBlockEntryThunk(block_graph, &fast_path_block_))
+      return false;
+  }
+
   return true;
 }
 
@@ -235,9 +260,15 @@ bool BasicBlockEntryHookTransform::TransformBasicBlockSubGraph(
     // Assemble entry hook instrumentation into the instruction stream.
     BasicBlockAssembler bb_asm(bb->instructions().begin(), &bb->instructions());
 
-    bb_asm.push(basic_block_id);
-    bb_asm.push(module_data);
-    bb_asm.call(bb_entry_hook);
+    if (fast_path_block_ != NULL) {
+      // The fast-path thunk implies the module_data parameter.
+      bb_asm.push(basic_block_id);
+      bb_asm.call(Immediate(fast_path_block_, 0));
+    } else {
+      bb_asm.push(basic_block_id);
+      bb_asm.push(module_data);
+      bb_asm.call(bb_entry_hook);
+    }
 
     bb_ranges_.push_back(source_range);
   }
@@ -270,6 +301,13 @@ bool BasicBlockEntryHookTransform::PostBlockGraphIteration(
   CHECK(frequency_data.Init(0, add_frequency_data_.frequency_data_block()));
   frequency_data->fs_slot = 0;
   frequency_data->tls_index = TLS_OUT_OF_INDEXES;
+  if (fast_path_block_ != NULL) {
+    frequency_data->inline_counter_size = sizeof(uint8_t);
+    frequency_data->inline_tls_offset = inline_tls_offset_;
+  } else {
+    frequency_data->inline_counter_size = 0;
+    frequency_data->inline_tls_offset = 0;
+  }
 
   // Add the module entry thunks.
   EntryThunkTransform add_thunks;
@@ -487,5 +525,130 @@ bool BasicBlockEntryHookTransform::FindOrCreateThunk(
   return true;
 }
 
+bool BasicBlockEntryHookTransform::CreateBasicBlockEntryThunk(
+    BlockGraph* block_graph,
+    BlockGraph::Block** fast_path_block) {
+  DCHECK(block_graph != NULL);
+  DCHECK(fast_path_block != NULL);
+  DCHECK(thunk_section_ != NULL);
+  DCHECK(bb_entry_hook_ref_.IsValid());
+
+  BlockGraph::Block* module_data_block =
+      add_frequency_data_.frequency_data_block();
+  DCHECK(module_data_block != NULL);
+
+  // The thunk is called with the basic block id on the stack, and cleans it
+  // up on return. It looks like:
+  //
+  //   lookup:  push eax
+  //            lahf
+  //            seto al
+  //            push ecx
+  //            push edx
+  //            mov ecx, [module_data.inline_tls_index]
+  //            mov edx, fs:[0x2C]
+  //            mov edx, [edx + ecx * 4]
+  //            mov edx, [edx + inline_tls_offset]
+  //            test edx, edx
+  //            jz slow
+  //   inc:     mov ecx, [esp + 0x10]
+  //            inc byte ptr [edx + ecx]
+  //            jz wrapped
+  //   done:    [restore registers and flags]
+  //            ret 4
+  //   wrapped: mov byte ptr [edx + ecx], 0xFF
+  //   slow:    [restore registers and flags]
+  //            push [esp + 4]
+  //            push module_data
+  //            call [bb_entry_hook]
+  //            ret 4
+  //
+  // The counters pointer is NULL until the agent allocates them on the first
+  // event of a thread. A counter wrapping around is rolled back, and the event
+  // is instead handed to the agent, which folds the counter into the
+  // module-wide frequency data.
+  BasicBlockSubGraph subgraph;
+  BasicBlockSubGraph::BlockDescription* desc = subgraph.AddBlockDescription(
+      kFastPathThunkName, NULL, BlockGraph::CODE_BLOCK, thunk_section_->id(),
+      1, 0);
+  BasicCodeBlock* lookup_bb = subgraph.AddBasicCodeBlock("lookup");
+  BasicCodeBlock* inc_bb = subgraph.AddBasicCodeBlock("inc");
+  BasicCodeBlock* done_bb = subgraph.AddBasicCodeBlock("done");
+  BasicCodeBlock* wrapped_bb = subgraph.AddBasicCodeBlock("wrapped");
+  BasicCodeBlock* slow_bb = subgraph.AddBasicCodeBlock("slow");
+  desc->basic_block_order.push_back(lookup_bb);
+  desc->basic_block_order.push_back(inc_bb);
+  desc->basic_block_order.push_back(done_bb);
+  desc->basic_block_order.push_back(wrapped_bb);
+  desc->basic_block_order.push_back(slow_bb);
+
+  BasicBlockAssembler lookup(lookup_bb->instructions().begin(),
+                             &lookup_bb->instructions());
+  lookup.push(assm::eax);
+  lookup.lahf();
+  lookup.set(assm::kOverflow, assm::eax);
+  lookup.push(assm::ecx);
+  lookup.push(assm::edx);
+  lookup.mov(assm::ecx, Operand(Displacement(
+      module_data_block,
+      offsetof(ThreadLocalIndexedFrequencyData, inline_tls_index))));
+  lookup.mov_fs(assm::edx, Immediate(kOffsetTebStorage));
+  lookup.mov(assm::edx, Operand(assm::edx, assm::ecx, assm::kTimes4));
+  lookup.mov(assm::edx,
+             Operand(assm::edx, Displacement(inline_tls_offset_)));
+  lookup.test(assm::edx, assm::edx);
+  AddSuccessorBetween(Successor::kConditionEqual, lookup_bb, slow_bb);
+  AddSuccessorBetween(Successor::kConditionNotEqual, lookup_bb, inc_bb);
+
+  BasicBlockAssembler inc(inc_bb->instructions().begin(),
+                          &inc_bb->instructions());
+  inc.mov(assm::ecx, Operand(assm::esp, Displacement(0x10)));
+  inc.inc(Operand(assm::edx, assm::ecx, assm::kTimes1));
+  AddSuccessorBetween(Successor::kConditionEqual, inc_bb, wrapped_bb);
+  AddSuccessorBetween(Successor::kConditionNotEqual, inc_bb, done_bb);
+
+  BasicBlockAssembler done(done_bb->instructions().begin(),
+                           &done_bb->instructions());
+  done.pop(assm::edx);
+  done.pop(assm::ecx);
+  done.add(assm::al, Immediate(0x7F, assm::kSize8Bit));
+  done.sahf();
+  done.pop(assm::eax);
+  done.ret(4);
+
+  BasicBlockAssembler wrapped(wrapped_bb->instructions().begin(),
+                              &wrapped_bb->instructions());
+  wrapped.mov_b(Operand(assm::edx, assm::ecx, assm::kTimes1),
+                Immediate(0xFF, assm::kSize8Bit));
+  AddSuccessorBetween(Successor::kConditionTrue, wrapped_bb, slow_bb);
+
+  // The slow path rebuilds the stack frame expected by the agent hook.
+  BasicBlockAssembler slow(slow_bb->instructions().begin(),
+                           &slow_bb->instructions());
+  slow.pop(assm::edx);
+  slow.pop(assm::ecx);
+  slow.add(assm::al, Immediate(0x7F, assm::kSize8Bit));
+  slow.sahf();
+  slow.pop(assm::eax);
+  slow.push(Operand(assm::esp, Displacement(4)));
+  slow.push(Immediate(module_data_block, 0));
+  slow.call(Operand(Displacement(bb_entry_hook_ref_.referenced(),
+                                 bb_entry_hook_ref_.offset())));
+  slow.ret(4);
+
+  // Condense the whole mess into a block.
+  BlockBuilder block_builder(block_graph);
+  if (!block_builder.Merge(&subgraph)) {
+    LOG(ERROR) << "Failed to build the fast-path thunk.";
+    return false;
+  }
+
+  // Exactly one new block should have been created.
+  DCHECK_EQ(1u, block_builder.new_blocks().size());
+  *fast_path_block = block_builder.new_blocks().front();
+
+  return true;
+}
+
 }  // namespace transforms
 }  // namespace instrument
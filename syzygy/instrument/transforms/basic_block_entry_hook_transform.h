@@ -36,6 +36,11 @@ namespace transforms {
 // The entry-hook function is responsible for being non-disruptive to the
 // calling environment. I.e., it must preserve all volatile registers, any
 // registers it uses, and the processor flags.
+//
+// With the inline fast path, each code basic-block instead calls a thunk that
+// is injected in the instrumented image. The thunk increments a per-thread
+// byte counter, found through an implicit TLS slot, and only calls into the
+// agent for the first event of a thread and when a counter wraps around.
 class BasicBlockEntryHookTransform
     : public block_graph::transforms::IterativeTransformImpl<
           BasicBlockEntryHookTransform>,
@@ -72,11 +77,11 @@ class BasicBlockEntryHookTransform
   }
 
   // Returns a flag denoting whether or not the instrumented application should
-  // call the fast-path hook.
+  // call the fast-path thunk.
   bool inline_fast_path() { return set_inline_fast_path_; }
 
   // Set a flag denoting whether or not the instrumented application should
-  // call the fast-path hook.
+  // call the fast-path thunk.
   void set_inline_fast_path(bool value) {
     set_inline_fast_path_ = value;
   }
@@ -163,6 +168,14 @@ class BasicBlockEntryHookTransform
   // The entry hook to which basic-block entry events are directed.
   BlockGraph::Reference bb_entry_hook_ref_;
 
+  // The fast-path thunk to which basic-block entry events are directed when
+  // inlining the fast path. This is NULL otherwise.
+  BlockGraph::Block* fast_path_block_;
+
+  // The offset of the implicit TLS slot holding the per-thread counters used
+  // by the fast-path thunk.
+  size_t inline_tls_offset_;
+
   // The section where the entry-point thunks were placed. This will only be
   // non-NULL after a successful application of the transform. This value is
   // retained for unit-testing purposes.
@@ -175,7 +188,7 @@ class BasicBlockEntryHookTransform
   // code; otherwise, the thunks will not have src ranges set.
   bool set_src_ranges_for_thunks_;
 
-  // If true, the instrumented application calls a fast injected hook before
+  // If true, the instrumented application calls a fast injected thunk before
   // falling back to the hook in the agent.
   bool set_inline_fast_path_;
 
@@ -49,6 +49,7 @@ using common::kBasicBlockFrequencyDataVersion;
 class TestBasicBlockEntryHookTransform : public BasicBlockEntryHookTransform {
  public:
   using BasicBlockEntryHookTransform::bb_entry_hook_ref_;
+  using BasicBlockEntryHookTransform::fast_path_block_;
   using BasicBlockEntryHookTransform::thunk_section_;
 
   BlockGraph::Block* frequency_data_block() {
@@ -170,6 +171,8 @@ void BasicBlockEntryHookTransformTest::CheckBasicBlockInstrumentation(
         const Instruction& inst2 = *(++inst_iter);
         EXPECT_EQ(I_CALL, inst2.representation().opcode);
         ASSERT_EQ(1U, inst2.references().size());
+        EXPECT_EQ(tx_.fast_path_block_,
+                  inst2.references().begin()->second.block());
       }
     }
     EXPECT_NE(0U, num_basic_blocks);
@@ -223,5 +226,52 @@ TEST_F(BasicBlockEntryHookTransformTest, ApplyAgentInstrumentation) {
   CheckBasicBlockInstrumentation(kAgentInstrumentation);
 }
 
+TEST_F(BasicBlockEntryHookTransformTest, ApplyFastPathInstrumentation) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+
+  // Apply the transform.
+  tx_.set_inline_fast_path(true);
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &tx_, policy_, &block_graph_, header_block_));
+  ASSERT_TRUE(tx_.frequency_data_block() != NULL);
+  ASSERT_TRUE(tx_.thunk_section_ != NULL);
+  ASSERT_TRUE(tx_.bb_entry_hook_ref_.IsValid());
+  ASSERT_TRUE(tx_.fast_path_block_ != NULL);
+  ASSERT_LT(0u, tx_.bb_ranges().size());
+
+  // The fast-path thunk lives with the other thunks, and calls into the agent.
+  EXPECT_EQ(tx_.thunk_section_->id(), tx_.fast_path_block_->section());
+  bool references_entry_hook = false;
+  for (const auto& ref : tx_.fast_path_block_->references()) {
+    if (ref.second.referenced() == tx_.bb_entry_hook_ref_.referenced())
+      references_entry_hook = true;
+  }
+  EXPECT_TRUE(references_entry_hook);
+
+  // Validate the inline counters configuration.
+  block_graph::ConstTypedBlock<ThreadLocalIndexedFrequencyData> frequency_data;
+  ASSERT_TRUE(frequency_data.Init(0, tx_.frequency_data_block()));
+  EXPECT_EQ(sizeof(uint8_t), frequency_data->inline_counter_size);
+  EXPECT_EQ(TLS_OUT_OF_INDEXES, frequency_data->tls_index);
+  EXPECT_EQ(0U, frequency_data->fs_slot);
+  EXPECT_EQ(sizeof(uint32_t), frequency_data->module_data.frequency_size);
+
+  // The TLS directory should point the loader to the inline TLS index.
+  bool tls_index_referenced = false;
+  for (const auto& referrer : tx_.frequency_data_block()->referrers()) {
+    BlockGraph::Reference ref;
+    ASSERT_TRUE(referrer.first->GetReference(referrer.second, &ref));
+    if (referrer.first->type() == BlockGraph::DATA_BLOCK &&
+        ref.offset() == static_cast<BlockGraph::Offset>(offsetof(
+            ThreadLocalIndexedFrequencyData, inline_tls_index))) {
+      tls_index_referenced = true;
+    }
+  }
+  EXPECT_TRUE(tls_index_referenced);
+
+  // Validate that all basic block have been instrumented.
+  CheckBasicBlockInstrumentation(kFastPathInstrumentation);
+}
+
 }  // namespace transforms
 }  // namespace instrument
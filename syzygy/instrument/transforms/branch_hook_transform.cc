@@ -345,6 +345,7 @@ bool BranchHookTransform::PostBlockGraphIteration(
   CHECK(frequency_data.Init(0, add_frequency_data_.frequency_data_block()));
   frequency_data->fs_slot = fs_slot_;
   frequency_data->tls_index = TLS_OUT_OF_INDEXES;
+  frequency_data->inline_counter_size = 0;
 
   // Add the module entry thunks.
   EntryThunkTransform add_thunks;
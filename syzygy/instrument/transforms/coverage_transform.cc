@@ -70,7 +70,8 @@ CoverageInstrumentationTransform::CoverageInstrumentationTransform()
                            "Basic-Block Frequency Data",
                            common::kBasicBlockFrequencyDataVersion,
                            common::IndexedFrequencyData::COVERAGE,
-                           sizeof(common::IndexedFrequencyData)) {
+                           sizeof(common::IndexedFrequencyData)),
+      inline_bitmap_(false) {
   // Initialize the EntryThunkTransform.
   entry_thunk_tx_.set_instrument_unsafe_references(false);
   entry_thunk_tx_.set_only_instrument_module_entry(true);
@@ -87,6 +88,9 @@ bool CoverageInstrumentationTransform::TransformBasicBlockSubGraph(
   BlockGraph::Block* data_block = add_bb_freq_data_tx_.frequency_data_block();
   DCHECK(data_block != NULL);
   DCHECK_EQ(sizeof(IndexedFrequencyData), data_block->data_size());
+  BlockGraph::Block* buffer_block =
+      add_bb_freq_data_tx_.frequency_data_buffer_block();
+  DCHECK(buffer_block != NULL);
 
   // Iterate over the basic blocks.
   BasicBlockSubGraph::BBCollection::iterator it =
@@ -105,18 +109,26 @@ bool CoverageInstrumentationTransform::TransformBasicBlockSubGraph(
       return false;
     }
 
-    // We prepend each basic code block with the following instructions:
-    //   0. push eax
-    //   1. mov eax, dword ptr[data.frequency_data]
-    //   2. mov byte ptr[eax + basic_block_index], 1
-    //   3. pop eax
     BasicBlockAssembler assm(bb->instructions().begin(), &bb->instructions());
 
-    // Prepend the instrumentation instructions.
-    assm.push(eax);
-    assm.mov(eax, Operand(Displacement(data_block, kFrequencyDataOffset)));
-    assm.mov_b(Operand(eax, Displacement(bb_ranges_.size())), Immediate(1));
-    assm.pop(eax);
+    if (inline_bitmap_) {
+      // In inline bitmap mode we prepend each basic code block with:
+      //   0. mov byte ptr[buffer + basic_block_index], 1
+      // The buffer is only sized once all the basic blocks are known, so the
+      // reference is based at its start.
+      assm.mov_b(Operand(Displacement(buffer_block, bb_ranges_.size(), 0)),
+                 Immediate(1));
+    } else {
+      // We prepend each basic code block with the following instructions:
+      //   0. push eax
+      //   1. mov eax, dword ptr[data.frequency_data]
+      //   2. mov byte ptr[eax + basic_block_index], 1
+      //   3. pop eax
+      assm.push(eax);
+      assm.mov(eax, Operand(Displacement(data_block, kFrequencyDataOffset)));
+      assm.mov_b(Operand(eax, Displacement(bb_ranges_.size())), Immediate(1));
+      assm.pop(eax);
+    }
 
     bb_ranges_.push_back(source_range);
   }
@@ -19,6 +19,13 @@
 // (2) Grabs an entry hook and wires it up the run-time library.
 // (3) Adds a read/write data section containing code coverage information.
 // (4) Instruments each basic block to gather basic block visit information.
+//
+// By default the basic blocks are marked as visited through the frequency data
+// pointer, which the agent redirects to a trace file segment. In inline bitmap
+// mode they are instead marked with a single store to the statically allocated
+// frequency data buffer, which needs neither a scratch register nor a load.
+// The agent then copies that buffer to the trace file when the module goes
+// away.
 
 #ifndef SYZYGY_INSTRUMENT_TRANSFORMS_COVERAGE_TRANSFORM_H_
 #define SYZYGY_INSTRUMENT_TRANSFORMS_COVERAGE_TRANSFORM_H_
@@ -67,6 +74,9 @@ class CoverageInstrumentationTransform
   //      as its unique ID.
   const RelativeAddressRangeVector& bb_ranges() const { return bb_ranges_; }
 
+  bool inline_bitmap() const { return inline_bitmap_; }
+  void set_inline_bitmap(bool inline_bitmap) { inline_bitmap_ = inline_bitmap; }
+
   // @}
 
   // @name Pass-throughs to EntryThunkTransform.
@@ -127,6 +137,10 @@ class CoverageInstrumentationTransform
   // Stores the RVAs in the original image for each instrumented basic block.
   RelativeAddressRangeVector bb_ranges_;
 
+  // When activated, the basic blocks are marked as visited directly in the
+  // frequency data buffer.
+  bool inline_bitmap_;
+
   DISALLOW_COPY_AND_ASSIGN(CoverageInstrumentationTransform);
 };
 
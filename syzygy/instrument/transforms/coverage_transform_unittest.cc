@@ -16,6 +16,8 @@
 
 #include "syzygy/instrument/transforms/coverage_transform.h"
 
+#include <set>
+
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/transform.h"
 #include "syzygy/block_graph/typed_block.h"
@@ -65,5 +67,37 @@ TEST_F(CoverageInstrumentationTransformTest, Apply) {
       coverage_data.OffsetOf(coverage_data->frequency_data)));
 }
 
+TEST_F(CoverageInstrumentationTransformTest, ApplyInlineBitmap) {
+  CoverageInstrumentationTransform tx;
+  EXPECT_FALSE(tx.inline_bitmap());
+  tx.set_inline_bitmap(true);
+  EXPECT_TRUE(tx.inline_bitmap());
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &tx, policy_, &block_graph_, header_block_));
+
+  BlockGraph::Block* buffer_block = tx.frequency_data_buffer_block();
+  ASSERT_EQ(tx.bb_ranges().size(), buffer_block->size());
+
+  // Besides the frequency data, each instrumented basic block refers to its
+  // own entry of the buffer.
+  std::set<BlockGraph::Offset> entries;
+  BlockGraph::Block::ReferrerSet::const_iterator it =
+      buffer_block->referrers().begin();
+  for (; it != buffer_block->referrers().end(); ++it) {
+    if (it->first == tx.frequency_data_block())
+      continue;
+    EXPECT_EQ(BlockGraph::CODE_BLOCK, it->first->type());
+
+    BlockGraph::Reference ref;
+    ASSERT_TRUE(it->first->GetReference(it->second, &ref));
+    EXPECT_EQ(0, ref.base());
+    EXPECT_LE(0, ref.offset());
+    EXPECT_GT(static_cast<BlockGraph::Offset>(buffer_block->size()),
+              ref.offset());
+    EXPECT_TRUE(entries.insert(ref.offset()).second);
+  }
+  EXPECT_EQ(tx.bb_ranges().size(), entries.size());
+}
+
 }  // namespace transforms
 }  // namespace instrument
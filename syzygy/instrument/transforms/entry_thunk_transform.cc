@@ -33,12 +33,48 @@ using block_graph::BasicBlockSubGraph;
 using block_graph::BlockBuilder;
 using block_graph::BlockGraph;
 using block_graph::Displacement;
+using block_graph::Immediate;
 using block_graph::Operand;
 using block_graph::TransformPolicyInterface;
 using pe::transforms::PEAddImportsTransform;
 
 typedef pe::transforms::ImportedModule ImportedModule;
 
+namespace {
+
+// The opcode of a call with a 32-bit PC-relative displacement.
+const uint8_t kCallRel32Opcode = 0xE8;
+
+// The inverse of EntryThunkTransform::kStubSize modulo 2^32. Multiplying a
+// multiple of the stub size by this divides it exactly.
+const uint32_t kStubSizeInverse = 0xCCCCCCCD;
+
+// Gives the @p size bytes of @p thunk at @p offset a source range synonymous
+// with @p destination, if it has one.
+void AddThunkSourceRange(const pe::EntryPoint& destination,
+                         BlockGraph::Offset offset,
+                         BlockGraph::Size size,
+                         BlockGraph::Block* thunk) {
+  DCHECK(destination.first != NULL);
+  DCHECK(thunk != NULL);
+
+  const BlockGraph::Block::SourceRanges& source_ranges =
+      destination.first->source_ranges();
+  const BlockGraph::Block::SourceRanges::RangePair* source =
+      source_ranges.FindRangePair(destination.second, size);
+  if (source == NULL)
+    return;
+
+  // Calculate the offset into the range.
+  size_t offs = destination.second - source->first.start();
+  BlockGraph::Block::DataRange data(offset, size);
+  BlockGraph::Block::SourceRange src(source->second.start() + offs, size);
+  bool pushed = thunk->source_ranges().Push(data, src);
+  DCHECK(pushed);
+}
+
+}  // namespace
+
 const char EntryThunkTransform::kTransformName[] =
     "EntryThunkTransform";
 
@@ -49,12 +85,14 @@ const char EntryThunkTransform::kExeMainEntryHookName[] =
     "_indirect_penter_exemain";
 const char EntryThunkTransform::kDefaultInstrumentDll[] =
     "call_trace_client.dll";
+const size_t EntryThunkTransform::kStubSize = 5;
 
 EntryThunkTransform::EntryThunkTransform()
     : thunk_section_(NULL),
       instrument_unsafe_references_(true),
       src_ranges_for_thunks_(false),
       only_instrument_module_entry_(false),
+      compact_thunks_(false),
       instrument_dll_name_(kDefaultInstrumentDll) {
 }
 
@@ -175,6 +213,18 @@ bool EntryThunkTransform::OnBlock(const TransformPolicyInterface* policy,
   return InstrumentCodeBlock(block_graph, block);
 }
 
+bool EntryThunkTransform::PostBlockGraphIteration(
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    BlockGraph::Block* header_block) {
+  DCHECK(block_graph != NULL);
+
+  if (stub_destinations_.empty())
+    return true;
+
+  return CreateStubs(block_graph);
+}
+
 bool EntryThunkTransform::InstrumentCodeBlock(
     BlockGraph* block_graph, BlockGraph::Block* block) {
   DCHECK(block_graph != NULL);
@@ -277,6 +327,18 @@ bool EntryThunkTransform::InstrumentCodeBlockReferrer(
     param = &function_thunk_parameter_;
   }
 
+  // In compact mode the function thunks are stubs, which can only be laid out
+  // once all of them are known. Defer the update of the referrer until then.
+  if (compact_thunks_ && hook_ref == &hook_ref_) {
+    std::pair<StubIndexMap::iterator, bool> inserted = stub_indices_.insert(
+        std::make_pair(entry, stub_destinations_.size()));
+    if (inserted.second)
+      stub_destinations_.push_back(entry);
+    stub_referrers_.push_back(std::make_pair(referrer,
+                                             inserted.first->second));
+    return true;
+  }
+
   // Look for the reference in the thunk block map, and only create a new one
   // if it does not already exist.
   BlockGraph::Block* thunk_block = NULL;
@@ -365,24 +427,127 @@ BlockGraph::Block* EntryThunkTransform::CreateOneThunk(
     // read. The downside to this is that the symbols are now no longer unique,
     // and searching for a function by name may turn up either the function or
     // the thunk.
-    const BlockGraph::Block::SourceRanges& source_ranges =
-        destination.referenced()->source_ranges();
-    const BlockGraph::Block::SourceRanges::RangePair* source =
-        source_ranges.FindRangePair(destination.offset(), thunk->size());
-    if (source != NULL) {
-      // Calculate the offset into the range.
-      size_t offs = destination.offset() - source->first.start();
-      BlockGraph::Block::DataRange data(0, thunk->size());
-      BlockGraph::Block::SourceRange src(source->second.start() + offs,
-                                          thunk->size());
-      bool pushed = thunk->source_ranges().Push(data, src);
-      DCHECK(pushed);
-    }
+    AddThunkSourceRange(
+        pe::EntryPoint(destination.referenced(), destination.offset()),
+        0, thunk->size(), thunk);
   }
 
   return thunk;
 }
 
+bool EntryThunkTransform::CreateStubs(BlockGraph* block_graph) {
+  DCHECK(block_graph != NULL);
+  DCHECK(thunk_section_ != NULL);
+  DCHECK(!stub_destinations_.empty());
+
+  size_t num_stubs = stub_destinations_.size();
+
+  // All the stubs have the same shape, so they are laid out directly rather
+  // than assembled. Their references are set once the trampoline exists.
+  BlockGraph::Block* stubs = block_graph->AddBlock(
+      BlockGraph::CODE_BLOCK, num_stubs * kStubSize, "entry_thunk_stubs");
+  stubs->set_section(thunk_section_->id());
+  uint8_t* stub_data = stubs->AllocateData(stubs->size());
+  for (size_t i = 0; i < num_stubs; ++i) {
+    BlockGraph::Offset offset = static_cast<BlockGraph::Offset>(i * kStubSize);
+    stub_data[offset] = kCallRel32Opcode;
+    if (src_ranges_for_thunks_)
+      AddThunkSourceRange(stub_destinations_[i], offset, kStubSize, stubs);
+  }
+
+  // The function table goes with the other read-only data.
+  BlockGraph::Section* rdata = block_graph->FindOrAddSection(
+      pe::kReadOnlyDataSectionName, pe::kReadOnlyDataCharacteristics);
+  BlockGraph::Block* table = block_graph->AddBlock(
+      BlockGraph::DATA_BLOCK, num_stubs * sizeof(core::AbsoluteAddress),
+      "entry_thunk_table");
+  table->set_section(rdata->id());
+  table->AllocateData(table->size());
+  for (size_t i = 0; i < num_stubs; ++i) {
+    const pe::EntryPoint& destination = stub_destinations_[i];
+    table->SetReference(static_cast<BlockGraph::Offset>(
+                            i * sizeof(core::AbsoluteAddress)),
+                        BlockGraph::Reference(BlockGraph::ABSOLUTE_REF,
+                                              sizeof(core::AbsoluteAddress),
+                                              destination.first,
+                                              destination.second,
+                                              destination.second));
+  }
+
+  BasicBlockSubGraph bbsg;
+  BasicBlockSubGraph::BlockDescription* block_desc = bbsg.AddBlockDescription(
+      "entry_thunk_trampoline",
+      NULL,
+      BlockGraph::CODE_BLOCK,
+      thunk_section_->id(),
+      1,
+      0);
+  BasicCodeBlock* bb = bbsg.AddBasicCodeBlock("entry_thunk_trampoline");
+  block_desc->basic_block_order.push_back(bb);
+  BasicBlockAssembler assm(bb->instructions().begin(),
+                           &bb->instructions());
+
+  // On entry the stack holds the return address into the calling stub,
+  // followed by the return address of the instrumented call. The flags are
+  // preserved along with eax, as the hook expects the state of the original
+  // call.
+  assm.push(assm::eax);
+  assm.pushfd();
+  assm.mov(assm::eax, Operand(assm::esp, Displacement(8)));
+
+  // The stub at index i returns to stubs + (i + 1) * kStubSize.
+  assm.sub(assm::eax, Immediate(stubs, kStubSize, 0));
+  assm.imul(assm::eax, assm::eax,
+            Immediate(kStubSizeInverse, assm::kSize32Bit));
+  assm.mov(assm::eax,
+           Operand(assm::eax, assm::kTimes4, Displacement(table, 0)));
+
+  // Replace the return address into the stub with the original function and
+  // restore the state of the call, pushing the parameter if there is one.
+  if (FunctionThunkIsParameterized()) {
+    assm.mov(Operand(assm::esp, Displacement(8)), function_thunk_parameter_);
+    assm.xchg(assm::eax, Operand(assm::esp, Displacement(4)));
+    assm.popfd();
+  } else {
+    assm.mov(Operand(assm::esp, Displacement(8)), assm::eax);
+    assm.popfd();
+    assm.pop(assm::eax);
+  }
+  assm.jmp(Operand(Displacement(hook_ref_.referenced(), hook_ref_.offset())));
+
+  BlockBuilder block_builder(block_graph);
+  if (!block_builder.Merge(&bbsg)) {
+    LOG(ERROR) << "Failed to build trampoline block.";
+    return false;
+  }
+  DCHECK_EQ(1u, block_builder.new_blocks().size());
+  BlockGraph::Block* trampoline = block_builder.new_blocks().front();
+
+  for (size_t i = 0; i < num_stubs; ++i) {
+    stubs->SetReference(static_cast<BlockGraph::Offset>(i * kStubSize + 1),
+                        BlockGraph::Reference(BlockGraph::PC_RELATIVE_REF,
+                                              sizeof(core::AbsoluteAddress),
+                                              trampoline,
+                                              0, 0));
+  }
+
+  // Finally, update the referrers to point to their stubs.
+  for (size_t i = 0; i < stub_referrers_.size(); ++i) {
+    const BlockGraph::Block::Referrer& referrer = stub_referrers_[i].first;
+    BlockGraph::Reference ref;
+    bool found = referrer.first->GetReference(referrer.second, &ref);
+    DCHECK(found);
+
+    BlockGraph::Offset offset =
+        static_cast<BlockGraph::Offset>(stub_referrers_[i].second * kStubSize);
+    BlockGraph::Reference new_ref(ref.type(), ref.size(), stubs, offset,
+                                  offset);
+    referrer.first->SetReference(referrer.second, new_ref);
+  }
+
+  return true;
+}
+
 bool EntryThunkTransform::GetEntryPoints(BlockGraph::Block* header_block) {
   // Get the TLS initializer entry-points. These have the same signature and
   // call patterns to DllMain.
@@ -43,12 +43,29 @@
 //
 // Prior to executing the thunk the stack is set up as if the call was going to
 // be directly to the original function.
+//
+// In compact mode the function thunks are instead laid out as a dense array
+// of 5-byte stubs, all of which call a single shared trampoline:
+//
+//   0xe8 0x44 0x33 0x22 0x11       call trampoline
+//
+// The trampoline derives the index of the stub from the return address
+// pushed by the call, and replaces that return address with the address of
+// the original function, which it looks up in a table held in a read-only data
+// section. It then pushes the parameter, if any, and jumps to the hook, which
+// thus sees the same stack as with a regular thunk. This saves a block per
+// thunk, and 2 bytes of image per thunk (7 with a parameter), at the cost of a
+// few instructions for each hooked call. Module entry points always get
+// regular thunks.
 
 #ifndef SYZYGY_INSTRUMENT_TRANSFORMS_ENTRY_THUNK_TRANSFORM_H_
 #define SYZYGY_INSTRUMENT_TRANSFORMS_ENTRY_THUNK_TRANSFORM_H_
 
+#include <map>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/strings/string_piece.h"
 #include "syzygy/block_graph/basic_block_assembler.h"
@@ -93,6 +110,11 @@ class EntryThunkTransform
     return only_instrument_module_entry_;
   }
 
+  void set_compact_thunks(bool compact_thunks) {
+    compact_thunks_ = compact_thunks;
+  }
+  bool compact_thunks() const { return compact_thunks_; }
+
   void set_instrument_dll_name(const base::StringPiece& instrument_dll_name) {
     instrument_dll_name.CopyToString(&instrument_dll_name_);
   }
@@ -136,8 +158,13 @@ class EntryThunkTransform
   // The name of the DLL imported default.
   static const char kDefaultInstrumentDll[];
 
+  // The size of a stub in compact mode.
+  static const size_t kStubSize;
+
  protected:
   typedef std::map<BlockGraph::Offset, BlockGraph::Block*> ThunkBlockMap;
+  typedef std::map<pe::EntryPoint, size_t> StubIndexMap;
+  typedef std::pair<BlockGraph::Block::Referrer, size_t> StubReferrer;
 
   // @name IterativeTransformImpl implementation.
   // @{
@@ -147,6 +174,9 @@ class EntryThunkTransform
   bool OnBlock(const TransformPolicyInterface* policy,
                BlockGraph* block_graph,
                BlockGraph::Block* block);
+  bool PostBlockGraphIteration(const TransformPolicyInterface* policy,
+                               BlockGraph* block_graph,
+                               BlockGraph::Block* header_block);
   // @}
 
   // Instrument a single block.
@@ -169,6 +199,12 @@ class EntryThunkTransform
                                     const BlockGraph::Reference& hook,
                                     const ImmediateType* parameter);
 
+  // Creates the stubs, the function table and the trampoline of the compact
+  // mode, and redirects the referrers of the stubs to them.
+  // @param block_graph the block-graph being instrumented.
+  // @returns true on success, false otherwise.
+  bool CreateStubs(BlockGraph* block_graph);
+
  private:
   friend IterativeTransformImpl<EntryThunkTransform>;
   friend NamedBlockGraphTransformImpl<EntryThunkTransform>;
@@ -200,6 +236,19 @@ class EntryThunkTransform
   // If true, only instrument DLL entry points.
   bool only_instrument_module_entry_;
 
+  // Iff true, function thunks are replaced with stubs calling a shared
+  // trampoline.
+  bool compact_thunks_;
+
+  // The destinations of the stubs, in stub order, and the index of the stub
+  // of each destination. Populated during the iteration in compact mode.
+  std::vector<pe::EntryPoint> stub_destinations_;
+  StubIndexMap stub_indices_;
+
+  // The references to redirect to the stubs once they are created, along
+  // with the index of the stub each of them is redirected to.
+  std::vector<StubReferrer> stub_referrers_;
+
   // If has a size of 32 bits, then entry thunks will be set up with an extra
   // parameter on the stack prior to the address of the original function.
   ImmediateType entry_thunk_parameter_;
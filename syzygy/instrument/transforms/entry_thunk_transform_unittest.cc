@@ -16,6 +16,7 @@
 
 #include "syzygy/instrument/transforms/entry_thunk_transform.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "gmock/gmock.h"
@@ -280,6 +281,85 @@ class EntryThunkTransformTest : public testing::Test {
     EXPECT_EQ(expected_entrypoints, CountEntryPoints(thunks));
   }
 
+  // @returns the only block named @p name, or NULL.
+  BlockGraph::Block* FindBlock(const std::string& name) {
+    BlockGraph::Block* found = NULL;
+    BlockGraph::BlockMap::iterator it = bg_.blocks_mutable().begin();
+    for (; it != bg_.blocks_mutable().end(); ++it) {
+      if (it->second.name() != name)
+        continue;
+      EXPECT_TRUE(found == NULL);
+      found = &it->second;
+    }
+    return found;
+  }
+
+  // Verifies that the reference at @p offset in @p referrer goes through a
+  // compact stub to @p destination at @p destination_offset.
+  void VerifyStubReference(BlockGraph::Block* referrer,
+                           BlockGraph::Offset offset,
+                           BlockGraph::Block* destination,
+                           BlockGraph::Offset destination_offset) {
+    BlockGraph::Block* stubs = FindBlock("entry_thunk_stubs");
+    BlockGraph::Block* table = FindBlock("entry_thunk_table");
+    ASSERT_TRUE(stubs != NULL);
+    ASSERT_TRUE(table != NULL);
+
+    BlockGraph::Reference ref;
+    ASSERT_TRUE(referrer->GetReference(offset, &ref));
+    ASSERT_EQ(stubs, ref.referenced());
+    BlockGraph::Offset stub_size =
+        static_cast<BlockGraph::Offset>(EntryThunkTransform::kStubSize);
+    ASSERT_EQ(0, ref.offset() % stub_size);
+    EXPECT_EQ(ref.offset(), ref.base());
+
+    BlockGraph::Reference table_ref;
+    ASSERT_TRUE(table->GetReference(
+        ref.offset() / stub_size * sizeof(AbsoluteAddress), &table_ref));
+    EXPECT_EQ(destination, table_ref.referenced());
+    EXPECT_EQ(destination_offset, table_ref.offset());
+  }
+
+  // Verifies that there are @p expected_stubs compact stubs, all of which
+  // call the trampoline.
+  void VerifyStubs(size_t expected_stubs) {
+    BlockGraph::Block* stubs = FindBlock("entry_thunk_stubs");
+    BlockGraph::Block* table = FindBlock("entry_thunk_table");
+    BlockGraph::Block* trampoline = FindBlock("entry_thunk_trampoline");
+    ASSERT_TRUE(stubs != NULL);
+    ASSERT_TRUE(table != NULL);
+    ASSERT_TRUE(trampoline != NULL);
+
+    BlockGraph::Section* thunk_section =
+        bg_.FindSection(common::kThunkSectionName);
+    ASSERT_TRUE(thunk_section != NULL);
+    EXPECT_EQ(thunk_section->id(), stubs->section());
+    EXPECT_EQ(thunk_section->id(), trampoline->section());
+    BlockGraph::Section* rdata =
+        bg_.FindSection(pe::kReadOnlyDataSectionName);
+    ASSERT_TRUE(rdata != NULL);
+    EXPECT_EQ(rdata->id(), table->section());
+
+    ASSERT_EQ(expected_stubs * EntryThunkTransform::kStubSize, stubs->size());
+    ASSERT_EQ(stubs->size(), stubs->data_size());
+    EXPECT_EQ(expected_stubs * sizeof(AbsoluteAddress), table->size());
+    EXPECT_EQ(expected_stubs, stubs->references().size());
+    EXPECT_EQ(expected_stubs, table->references().size());
+    for (size_t i = 0; i < expected_stubs; ++i) {
+      BlockGraph::Offset offset = static_cast<BlockGraph::Offset>(
+          i * EntryThunkTransform::kStubSize);
+      EXPECT_EQ(0xE8, stubs->data()[offset]);
+      BlockGraph::Reference ref;
+      ASSERT_TRUE(stubs->GetReference(offset + 1, &ref));
+      EXPECT_EQ(BlockGraph::PC_RELATIVE_REF, ref.type());
+      EXPECT_EQ(trampoline, ref.referenced());
+      EXPECT_EQ(0, ref.offset());
+    }
+
+    // The trampoline refers to the stubs, the table and the hook.
+    EXPECT_EQ(3u, trampoline->references().size());
+  }
+
   enum ImageType {
     DLL_IMAGE,
     EXE_IMAGE,
@@ -383,14 +463,17 @@ TEST_F(EntryThunkTransformTest, AccessorsAndMutators) {
   EXPECT_TRUE(tx.instrument_unsafe_references());
   EXPECT_FALSE(tx.src_ranges_for_thunks());
   EXPECT_FALSE(tx.only_instrument_module_entry());
+  EXPECT_FALSE(tx.compact_thunks());
 
   tx.set_instrument_unsafe_references(false);
   tx.set_src_ranges_for_thunks(true);
   tx.set_only_instrument_module_entry(true);
+  tx.set_compact_thunks(true);
 
   EXPECT_FALSE(tx.instrument_unsafe_references());
   EXPECT_TRUE(tx.src_ranges_for_thunks());
   EXPECT_TRUE(tx.only_instrument_module_entry());
+  EXPECT_TRUE(tx.compact_thunks());
 }
 
 TEST_F(EntryThunkTransformTest, ParameterizedThunks) {
@@ -647,5 +730,74 @@ TEST_F(EntryThunkTransformTest, InstrumentExeTLSEntrypoint) {
   EXPECT_EQ(num_sections_pre_transform_ + 1, bg_.sections().size());
 }
 
+TEST_F(EntryThunkTransformTest, InstrumentAllCompact) {
+  EntryThunkTransform transform;
+  ASSERT_NO_FATAL_FAILURE(SetEmptyDllEntryPoint());
+  transform.set_compact_thunks(true);
+
+  ASSERT_TRUE(ApplyBlockGraphTransform(
+      &transform, &policy_, &bg_, dos_header_block_));
+
+  // We should have three stubs - one each for the start of foo() and bar(),
+  // and one for the middle of foo().
+  ASSERT_NO_FATAL_FAILURE(VerifyStubs(3));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(foo_, 5, bar_, 0));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(foo_, 10, foo_, 0));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(bar_, 5, foo_, 5));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(array_, 0, foo_, 0));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(array_, 4, bar_, 0));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(array_, 8, foo_, 5));
+
+  // The .thunks section should have been added.
+  EXPECT_EQ(num_sections_pre_transform_ + 1, bg_.sections().size());
+}
+
+TEST_F(EntryThunkTransformTest, InstrumentAllCompactWithParamDebugFriendly) {
+  EntryThunkTransform transform;
+  ASSERT_NO_FATAL_FAILURE(SetEmptyDllEntryPoint());
+  transform.set_compact_thunks(true);
+  transform.set_src_ranges_for_thunks(true);
+  transform.SetFunctionThunkParameter(Immediate(0x11223344));
+
+  ASSERT_TRUE(ApplyBlockGraphTransform(
+      &transform, &policy_, &bg_, dos_header_block_));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubs(3));
+
+  // Each stub has a source range synonymous with its destination.
+  BlockGraph::Block* stubs = FindBlock("entry_thunk_stubs");
+  ASSERT_TRUE(stubs != NULL);
+  EXPECT_EQ(3u, stubs->source_ranges().size());
+
+  // The parameter is pushed by the trampoline.
+  BlockGraph::Block* trampoline = FindBlock("entry_thunk_trampoline");
+  ASSERT_TRUE(trampoline != NULL);
+  static const uint8_t kParam[] = { 0x44, 0x33, 0x22, 0x11 };
+  const uint8_t* end = trampoline->data() + trampoline->data_size();
+  EXPECT_NE(end, std::search(trampoline->data(), end,
+                             kParam, kParam + sizeof(kParam)));
+}
+
+TEST_F(EntryThunkTransformTest, InstrumentDllEntrypointCompact) {
+  EntryThunkTransform transform;
+  ASSERT_NO_FATAL_FAILURE(SetEntryPoint(foo_, DLL_IMAGE));
+  transform.set_compact_thunks(true);
+
+  ASSERT_TRUE(ApplyBlockGraphTransform(
+      &transform, &policy_, &bg_, dos_header_block_));
+
+  // The entry point keeps a regular thunk, the other destinations get stubs.
+  ASSERT_NO_FATAL_FAILURE(VerifyStubs(2));
+  BlockGraph::Block* thunk = FindBlock(
+      std::string("foo") + common::kThunkSuffix);
+  ASSERT_TRUE(thunk != NULL);
+  EXPECT_EQ(sizeof(Thunk), thunk->size());
+
+  BlockGraph::Reference ref;
+  ASSERT_TRUE(array_->GetReference(0, &ref));
+  EXPECT_EQ(thunk, ref.referenced());
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(array_, 4, bar_, 0));
+  ASSERT_NO_FATAL_FAILURE(VerifyStubReference(array_, 8, foo_, 5));
+}
+
 }  // namespace transforms
 }  // namespace instrument
@@ -52,6 +52,8 @@ using pe::transforms::ImportedModule;
 
 const char kDefaultModuleName[] = "basic_block_entry_client.dll";
 const char kJumpTableCaseCounter[] = "_increment_indexed_freq_data";
+const char kJumpTableCaseCounterBuffered[] =
+    "_increment_indexed_freq_data_buffered";
 const char kThunkSuffix[] = "_jump_table_thunk";
 
 // Sets up the jump table counter hook import.
@@ -59,12 +61,14 @@ const char kThunkSuffix[] = "_jump_table_thunk";
 // @param block_graph The block-graph to populate.
 // @param header_block The header block from block_graph.
 // @param module_name The name of the module implementing the hooks.
+// @param buffering true to import the buffered variant of the hook.
 // @param jump_table_case_counter will refer to the imported hook function.
 // @returns true on success, false otherwise.
 bool SetupCounterHook(const TransformPolicyInterface* policy,
                       BlockGraph* block_graph,
                       BlockGraph::Block* header_block,
                       const std::string& module_name,
+                      bool buffering,
                       BlockGraph::Reference* jump_table_case_counter) {
   DCHECK(block_graph != NULL);
   DCHECK(header_block != NULL);
@@ -73,7 +77,7 @@ bool SetupCounterHook(const TransformPolicyInterface* policy,
   // Setup the import module.
   ImportedModule module(module_name);
   size_t index_case_counter = module.AddSymbol(
-      kJumpTableCaseCounter,
+      buffering ? kJumpTableCaseCounterBuffered : kJumpTableCaseCounter,
       ImportedModule::kAlwaysImport);
 
   // Setup the add-imports transform.
@@ -109,6 +113,7 @@ JumpTableCaseCountTransform::JumpTableCaseCountTransform()
                           common::IndexedFrequencyData::JUMP_TABLE,
                           sizeof(common::IndexedFrequencyData)),
       instrument_dll_name_(kDefaultModuleName),
+      buffering_(false),
       jump_table_case_count_(0) {
 }
 
@@ -126,6 +131,7 @@ bool JumpTableCaseCountTransform::PreBlockGraphIteration(
                         block_graph,
                         header_block,
                         instrument_dll_name_,
+                        buffering_,
                         &jump_table_case_counter_hook_ref_)) {
     return false;
   }
@@ -46,6 +46,14 @@ class JumpTableCaseCountTransform
   // module and function names.
   JumpTableCaseCountTransform();
 
+  // @name Accessors and mutators.
+  // @{
+  // When buffering, the increments are queued per thread by the agent and
+  // committed in batches, rather than committed under a lock on each case.
+  bool buffering() const { return buffering_; }
+  void set_buffering(bool buffering) { buffering_ = buffering; }
+  // @}
+
  protected:
   typedef block_graph::BlockGraph BlockGraph;
   typedef block_graph::TransformPolicyInterface TransformPolicyInterface;
@@ -106,6 +114,9 @@ class JumpTableCaseCountTransform
   // The instrumentation dll used by this transform.
   std::string instrument_dll_name_;
 
+  // Flag indicating if event buffering is activated.
+  bool buffering_;
+
   // The counter used to get a unique ID for each case in a jump table.
   size_t jump_table_case_count_;
 
@@ -167,5 +167,22 @@ TEST_F(JumpTableCaseCountTransformTest, Apply) {
   DCHECK_EQ(frequency_data->num_entries, jump_table_entries);
 }
 
+TEST_F(JumpTableCaseCountTransformTest, ApplyWithBuffering) {
+  ASSERT_NO_FATAL_FAILURE(DecomposeTestDll());
+
+  // Activate buffering.
+  TestJumpTableCaseCountTransform tx;
+  EXPECT_FALSE(tx.buffering());
+  tx.set_buffering(true);
+  EXPECT_TRUE(tx.buffering());
+
+  // Apply the transform.
+  ASSERT_TRUE(block_graph::ApplyBlockGraphTransform(
+      &tx, policy_, &block_graph_, header_block_));
+  ASSERT_TRUE(tx.frequency_data_block() != NULL);
+  ASSERT_TRUE(tx.thunk_section() != NULL);
+  ASSERT_TRUE(tx.jump_table_case_counter_hook_ref()->IsValid());
+}
+
 }  // namespace transforms
 }  // namespace instrument
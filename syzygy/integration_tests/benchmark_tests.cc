@@ -0,0 +1,161 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/integration_tests/benchmark_tests.h"
+
+#include <windows.h>  // NOLINT
+#include <stdint.h>
+#include <string.h>
+
+#include "base/macros.h"
+
+namespace testing {
+
+namespace {
+
+// A simple linear congruential generator, so that the kernels do the same
+// work on every run.
+uint32_t NextRandom(uint32_t* state) {
+  *state = *state * 1664525 + 1013904223;
+  return *state >> 8;
+}
+
+// Allocates, fills and frees |kRounds| batches of blocks. Returns a checksum
+// of the contents of the blocks.
+unsigned int AllocationKernel(uint32_t seed) {
+  const size_t kBlockCount = 256;
+  const size_t kRounds = 64;
+  const size_t kMaxBlockSize = 512;
+
+  uint8_t* blocks[kBlockCount] = {};
+  size_t sizes[kBlockCount] = {};
+  unsigned int checksum = 0;
+  for (size_t round = 0; round < kRounds; ++round) {
+    for (size_t i = 0; i < kBlockCount; ++i) {
+      sizes[i] = 1 + NextRandom(&seed) % kMaxBlockSize;
+      blocks[i] = new uint8_t[sizes[i]];
+      ::memset(blocks[i], static_cast<int>(i), sizes[i]);
+    }
+    // Free in a different order than allocated, as real programs do.
+    for (size_t i = 0; i < kBlockCount; ++i) {
+      size_t j = (i * 7) % kBlockCount;
+      checksum += blocks[j][sizes[j] - 1] + sizes[j];
+      delete[] blocks[j];
+    }
+  }
+  return checksum;
+}
+
+DWORD WINAPI AllocationThreadProc(LPVOID param) {
+  return AllocationKernel(reinterpret_cast<uint32_t>(param));
+}
+
+}  // namespace
+
+unsigned int BenchmarkAllocation() {
+  return AllocationKernel(42);
+}
+
+unsigned int BenchmarkStrings() {
+  const size_t kWordCount = 64;
+  const size_t kRounds = 256;
+  static const char* kWords[] = {
+      "syzygy", "relink", "instrument", "asan", "coverage", "profile",
+      "bbentry", "decompose", "block", "graph", "image", "layout",
+  };
+
+  char buffer[kWordCount * 16] = {};
+  char copy[sizeof(buffer)] = {};
+  unsigned int checksum = 0;
+  uint32_t seed = 42;
+  for (size_t round = 0; round < kRounds; ++round) {
+    buffer[0] = '\0';
+    for (size_t i = 0; i < kWordCount; ++i) {
+      ::strcat(buffer, kWords[NextRandom(&seed) % arraysize(kWords)]);
+      ::strcat(buffer, " ");
+    }
+    ::strcpy(copy, buffer);
+    checksum += ::strlen(copy);
+    checksum += ::strcmp(copy, buffer) == 0 ? 1 : 0;
+    for (const char* match = ::strstr(copy, "graph"); match != NULL;
+         match = ::strstr(match + 1, "graph")) {
+      checksum += match - copy;
+    }
+    checksum += ::strchr(copy, 'z') != NULL ? 1 : 0;
+    checksum += ::memcmp(copy, kWords[round % arraysize(kWords)], 4) < 0;
+  }
+  return checksum;
+}
+
+unsigned int BenchmarkPointerChasing() {
+  struct Node {
+    Node* next;
+    unsigned int value;
+  };
+  const size_t kNodeCount = 16 * 1024;
+  const size_t kRounds = 16;
+
+  // Link the nodes in a random order, so that each step of the walk lands
+  // somewhere unrelated to the previous one.
+  Node* nodes = new Node[kNodeCount];
+  size_t* order = new size_t[kNodeCount];
+  for (size_t i = 0; i < kNodeCount; ++i)
+    order[i] = i;
+  uint32_t seed = 42;
+  for (size_t i = kNodeCount - 1; i > 0; --i) {
+    size_t j = NextRandom(&seed) % (i + 1);
+    size_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  for (size_t i = 0; i < kNodeCount; ++i) {
+    nodes[order[i]].next = &nodes[order[(i + 1) % kNodeCount]];
+    nodes[order[i]].value = static_cast<unsigned int>(i);
+  }
+
+  unsigned int checksum = 0;
+  Node* node = &nodes[order[0]];
+  for (size_t i = 0; i < kRounds * kNodeCount; ++i) {
+    checksum = checksum * 31 + node->value;
+    node = node->next;
+  }
+
+  delete[] order;
+  delete[] nodes;
+  return checksum;
+}
+
+unsigned int BenchmarkMultithreaded() {
+  const size_t kThreadCount = 4;
+
+  HANDLE threads[kThreadCount] = {};
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads[i] = ::CreateThread(NULL, 0, &AllocationThreadProc,
+                                reinterpret_cast<LPVOID>(i + 1), 0, NULL);
+    if (threads[i] == NULL)
+      return 0;
+  }
+  ::WaitForMultipleObjects(kThreadCount, threads, TRUE, INFINITE);
+
+  unsigned int checksum = 0;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    DWORD exit_code = 0;
+    ::GetExitCodeThread(threads[i], &exit_code);
+    checksum += exit_code;
+    ::CloseHandle(threads[i]);
+  }
+  return checksum;
+}
+
+}  // namespace testing
@@ -0,0 +1,38 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file declares the kernels used to measure the runtime overhead of the
+// instrumentation modes. Each of them does a fixed amount of representative
+// work and returns a checksum of it, which must not depend on the
+// instrumentation.
+#ifndef SYZYGY_INTEGRATION_TESTS_BENCHMARK_TESTS_H_
+#define SYZYGY_INTEGRATION_TESTS_BENCHMARK_TESTS_H_
+
+namespace testing {
+
+// Allocates, fills and frees many heap blocks of varying sizes.
+unsigned int BenchmarkAllocation();
+
+// Copies, concatenates, searches and compares C strings.
+unsigned int BenchmarkStrings();
+
+// Walks a linked list whose nodes are scattered through memory.
+unsigned int BenchmarkPointerChasing();
+
+// Runs allocation and computation concurrently on several threads.
+unsigned int BenchmarkMultithreaded();
+
+}  // namespace testing
+
+#endif  // SYZYGY_INTEGRATION_TESTS_BENCHMARK_TESTS_H_
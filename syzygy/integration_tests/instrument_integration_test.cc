@@ -20,6 +20,7 @@
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/time/time.h"
 #include "base/win/pe_image.h"
 #include "base/win/scoped_com_initializer.h"
 #include "gmock/gmock.h"
@@ -47,6 +48,7 @@
 #include "syzygy/pe/unittest_util.h"
 #include "syzygy/poirot/minidump_processor.h"
 #include "syzygy/testing/laa.h"
+#include "syzygy/testing/metrics.h"
 #include "syzygy/trace/agent_logger/agent_logger.h"
 #include "syzygy/trace/common/unittest_util.h"
 
@@ -78,6 +80,21 @@ const char kAsanAccessViolationLog[] =
     "SyzyASAN: Caught an invalid access via an access violation exception.";
 const char kAsanHandlingException[] = "SyzyASAN: Handling an exception.";
 const char kAsanHeapBufferOverflow[] = "SyzyASAN error: heap-buffer-overflow ";
+
+// The kernels used to measure the runtime overhead of instrumentation.
+struct BenchmarkKernel {
+  testing::EndToEndTestId id;
+  const char* name;
+};
+const BenchmarkKernel kBenchmarkKernels[] = {
+    {testing::kBenchmarkAllocation, "Allocation"},
+    {testing::kBenchmarkStrings, "Strings"},
+    {testing::kBenchmarkPointerChasing, "PointerChasing"},
+    {testing::kBenchmarkMultithreaded, "Multithreaded"},
+};
+
+// The number of times each kernel is run. The shortest run is kept.
+const size_t kBenchmarkRepetitions = 5;
 const char kAsanCorruptHeap[] = "SyzyASAN error: corrupt-heap ";
 const char kAsanHeapUseAfterFree[] = "SyzyASAN error: heap-use-after-free ";
 const char kAsanNearNullptrAccessHeapCorruption[] =
@@ -895,6 +912,71 @@ class LenientInstrumentAppIntegrationTest : public testing::PELibUnitTest {
 
   void AsanZebraHeapTest(bool enabled);
 
+  // Runs each benchmark kernel of the loaded test DLL.
+  // @param times_ms Receives the shortest wall time of each kernel, in
+  //     milliseconds.
+  // @param results Receives the result of each kernel.
+  void RunBenchmarks(std::vector<double>* times_ms,
+                     std::vector<unsigned int>* results) {
+    DCHECK(times_ms != NULL);
+    DCHECK(results != NULL);
+
+    times_ms->clear();
+    results->clear();
+    for (const BenchmarkKernel& kernel : kBenchmarkKernels) {
+      double best_ms = 0;
+      unsigned int result = 0;
+      for (size_t i = 0; i < kBenchmarkRepetitions; ++i) {
+        base::TimeTicks start = base::TimeTicks::Now();
+        result = InvokeTestDllFunction(kernel.id);
+        double elapsed_ms = (base::TimeTicks::Now() - start).InMillisecondsF();
+        if (i == 0 || elapsed_ms < best_ms)
+          best_ms = elapsed_ms;
+      }
+      times_ms->push_back(best_ms);
+      results->push_back(result);
+    }
+  }
+
+  // Measures the slowdown of the benchmark kernels when the test DLL is
+  // instrumented in @p mode, and emits it as a metric.
+  void InstrumentationOverheadTest(const std::string& mode) {
+    // Time the uninstrumented DLL first. It has the same name as the
+    // instrumented one, so it must be unloaded before the latter is loaded.
+    std::vector<double> baseline_ms;
+    std::vector<unsigned int> baseline_results;
+    ASSERT_NO_FATAL_FAILURE(LoadTestDll(
+        testing::GetExeRelativePath(testing::kIntegrationTestsDllName),
+        &module_));
+    ASSERT_NO_FATAL_FAILURE(RunBenchmarks(&baseline_ms, &baseline_results));
+    ASSERT_NO_FATAL_FAILURE(UnloadDll());
+
+    std::vector<double> instrumented_ms;
+    std::vector<unsigned int> instrumented_results;
+    ASSERT_NO_FATAL_FAILURE(StartService());
+    ASSERT_NO_FATAL_FAILURE(EndToEndTest(mode));
+    ASSERT_NO_FATAL_FAILURE(
+        RunBenchmarks(&instrumented_ms, &instrumented_results));
+    ASSERT_NO_FATAL_FAILURE(UnloadDll());
+    ASSERT_NO_FATAL_FAILURE(StopService());
+
+    // The instrumentation mustn't change what the kernels compute.
+    EXPECT_EQ(baseline_results, instrumented_results);
+
+    for (size_t i = 0; i < arraysize(kBenchmarkKernels); ++i) {
+      std::string prefix = base::StringPrintf(
+          "Syzygy.InstrumentationOverhead.%s.%s.", mode.c_str(),
+          kBenchmarkKernels[i].name);
+      testing::EmitMetric(prefix + "WallTimeMs", instrumented_ms[i]);
+      testing::EmitMetric(prefix + "BaselineWallTimeMs", baseline_ms[i]);
+      // Guard against a kernel too fast for the timer.
+      if (baseline_ms[i] > 0) {
+        testing::EmitMetric(prefix + "Slowdown",
+                            instrumented_ms[i] / baseline_ms[i]);
+      }
+    }
+  }
+
   void BBEntryInvokeTestDll() {
     EXPECT_EQ(42, InvokeTestDllFunction(testing::kBBEntryCallOnce));
     EXPECT_EQ(42, InvokeTestDllFunction(testing::kBBEntryCallTree));
@@ -1806,6 +1888,22 @@ TEST_F(InstrumentAppIntegrationTest, ProfileWithImportsEndToEnd) {
   ASSERT_NO_FATAL_FAILURE(ProfileCheckTestDll(true));
 }
 
+TEST_F(InstrumentAppIntegrationTest, AsanOverhead) {
+  ASSERT_NO_FATAL_FAILURE(InstrumentationOverheadTest("asan"));
+}
+
+TEST_F(InstrumentAppIntegrationTest, BBEntryOverhead) {
+  ASSERT_NO_FATAL_FAILURE(InstrumentationOverheadTest("bbentry"));
+}
+
+TEST_F(InstrumentAppIntegrationTest, CoverageOverhead) {
+  ASSERT_NO_FATAL_FAILURE(InstrumentationOverheadTest("coverage"));
+}
+
+TEST_F(InstrumentAppIntegrationTest, ProfileOverhead) {
+  ASSERT_NO_FATAL_FAILURE(InstrumentationOverheadTest("profile"));
+}
+
 TEST_F(InstrumentAppIntegrationTest, DeferredFreeTLS) {
   ASSERT_NO_FATAL_FAILURE(StartService());
   ASSERT_NO_FATAL_FAILURE(EndToEndTest("asan"));
@@ -31,6 +31,8 @@
         'bb_entry_tests.cc',
         'behavior_tests.h',
         'behavior_tests.cc',
+        'benchmark_tests.h',
+        'benchmark_tests.cc',
         'coverage_tests.h',
         'coverage_tests.cc',
         'deferred_free_tests.h',
@@ -182,6 +182,10 @@ namespace testing {
 #define END_TO_END_NON_ASAN_TESTS(decl)  \
     decl(kArrayComputation1, testing::ArrayComputation1)  \
     decl(kArrayComputation2, testing::ArrayComputation2)  \
+    decl(kBenchmarkAllocation, testing::BenchmarkAllocation)  \
+    decl(kBenchmarkStrings, testing::BenchmarkStrings)  \
+    decl(kBenchmarkPointerChasing, testing::BenchmarkPointerChasing)  \
+    decl(kBenchmarkMultithreaded, testing::BenchmarkMultithreaded)  \
     decl(kBBEntryCallOnce, BBEntryCallOnce)  \
     decl(kBBEntryCallTree, BBEntryCallTree)  \
     decl(kBBEntryCallRecursive, BBEntryCallRecursive)  \
@@ -16,6 +16,7 @@
 
 #include <Windows.h>  // NOLINT
 #include <DbgHelp.h>
+#include <ProcessSnapshot.h>
 #include <Psapi.h>
 #include <winternl.h>
 
@@ -50,10 +51,41 @@ const MINIDUMP_TYPE kFullDumpType = static_cast<MINIDUMP_TYPE>(
     MiniDumpWithHandleData |  // Get all handle information.
     MiniDumpWithUnloadedModules);  // Get unloaded modules when available.
 
+// The parts of a process captured by CaptureProcessSnapshot. These are the
+// flags documented for use with MiniDumpWriteDump.
+const PSS_CAPTURE_FLAGS kSnapshotCaptureFlags = static_cast<PSS_CAPTURE_FLAGS>(
+    PSS_CAPTURE_VA_CLONE | PSS_CAPTURE_HANDLES |
+    PSS_CAPTURE_HANDLE_NAME_INFORMATION | PSS_CAPTURE_HANDLE_BASIC_INFORMATION |
+    PSS_CAPTURE_HANDLE_TYPE_SPECIFIC_INFORMATION | PSS_CAPTURE_HANDLE_TRACE |
+    PSS_CAPTURE_THREADS | PSS_CAPTURE_THREAD_CONTEXT |
+    PSS_CAPTURE_THREAD_CONTEXT_EXTENDED | PSS_CREATE_BREAKAWAY |
+    PSS_CREATE_BREAKAWAY_OPTIONAL | PSS_CREATE_USE_VM_ALLOCATIONS |
+    PSS_CREATE_RELEASE_SECTION);
+
+// The process snapshot functions are only available from Windows 8.1, so they
+// are looked up at runtime.
+using PssCaptureSnapshotFunc = DWORD(WINAPI*)(HANDLE process_handle,
+                                              PSS_CAPTURE_FLAGS capture_flags,
+                                              DWORD thread_context_flags,
+                                              HPSS* snapshot_handle);
+using PssFreeSnapshotFunc = DWORD(WINAPI*)(HANDLE process_handle,
+                                           HPSS snapshot_handle);
+
+template <typename Func>
+Func GetKernel32Function(const char* name) {
+  HMODULE kernel32 = ::GetModuleHandle(L"kernel32.dll");
+  if (!kernel32)
+    return nullptr;
+  return reinterpret_cast<Func>(::GetProcAddress(kernel32, name));
+}
+
 class MinidumpCallbackHandler {
  public:
-  explicit MinidumpCallbackHandler(
-      const std::vector<MinidumpRequest::MemoryRange>* memory_ranges);
+  // @param memory_ranges The memory ranges to include in the dump.
+  // @param is_snapshot True if the dump is generated from a process snapshot.
+  MinidumpCallbackHandler(
+      const std::vector<MinidumpRequest::MemoryRange>* memory_ranges,
+      bool is_snapshot);
 
   const MINIDUMP_CALLBACK_INFORMATION* GetMINIDUMP_CALLBACK_INFORMATION() {
     return &minidump_callback_information_;
@@ -69,15 +101,18 @@ class MinidumpCallbackHandler {
 
   const std::vector<MinidumpRequest::MemoryRange>* memory_ranges_;
   size_t next_memory_range_index_;
+  bool is_snapshot_;
   MINIDUMP_CALLBACK_INFORMATION minidump_callback_information_;
 
   DISALLOW_COPY_AND_ASSIGN(MinidumpCallbackHandler);
 };
 
 MinidumpCallbackHandler::MinidumpCallbackHandler(
-    const std::vector<MinidumpRequest::MemoryRange>* memory_ranges)
+    const std::vector<MinidumpRequest::MemoryRange>* memory_ranges,
+    bool is_snapshot)
     : memory_ranges_(memory_ranges),
       next_memory_range_index_(0),
+      is_snapshot_(is_snapshot),
       minidump_callback_information_() {
   minidump_callback_information_.CallbackRoutine =
       &MinidumpCallbackHandler::CallbackRoutine;
@@ -129,6 +164,11 @@ BOOL CALLBACK MinidumpCallbackHandler::CallbackRoutine(
       callback_output->CheckCancel = FALSE;
       callback_output->Cancel = FALSE;
       return TRUE;
+
+    // Tell DbgHelp whether the process handle is a snapshot handle.
+    case IsProcessSnapshotCallback:
+      callback_output->Status = self->is_snapshot_ ? S_FALSE : S_OK;
+      return TRUE;
   }
   // Ignore other callback types.
   return FALSE;
@@ -202,21 +242,21 @@ DWORD GetRequiredAccessForMinidumpTypeImpl(bool is_full_type) {
   return required_access;
 }
 
-}  // namespace
-
-DWORD GetRequiredAccessForMinidumpType(MinidumpRequest::Type type) {
-  return GetRequiredAccessForMinidumpTypeImpl(type ==
-                                              MinidumpRequest::FULL_DUMP_TYPE);
-}
-
-DWORD GetRequiredAccessForMinidumpType(api::MinidumpType type) {
-  return GetRequiredAccessForMinidumpTypeImpl(type == api::FULL_DUMP_TYPE);
-}
-
-bool GenerateMinidump(const base::FilePath& destination,
-                      base::ProcessHandle target_process,
-                      base::PlatformThreadId thread_id,
-                      const MinidumpRequest& request) {
+// Generates a minidump of a process or of a process snapshot.
+// @param destination The path where the dump should be generated.
+// @param process_handle The process handle, or the snapshot handle if
+//     @p is_snapshot is true.
+// @param process_id The ID of the process.
+// @param is_snapshot True if @p process_handle is a snapshot handle.
+// @param thread_id The thread that threw the exception.
+// @param request The minidump parameters.
+// @returns true if the operation is successful.
+bool GenerateMinidumpImpl(const base::FilePath& destination,
+                          HANDLE process_handle,
+                          base::ProcessId process_id,
+                          bool is_snapshot,
+                          base::PlatformThreadId thread_id,
+                          const MinidumpRequest& request) {
   MINIDUMP_EXCEPTION_INFORMATION* dump_exception_pointers = nullptr;
   MINIDUMP_EXCEPTION_INFORMATION dump_exception_info;
 
@@ -269,10 +309,11 @@ bool GenerateMinidump(const base::FilePath& destination,
   std::vector<kasko::MinidumpRequest::MemoryRange> augmented_memory_ranges =
       AugmentMemoryRanges(&request.user_selected_memory_ranges);
 
-  MinidumpCallbackHandler callback_handler(&augmented_memory_ranges);
+  MinidumpCallbackHandler callback_handler(&augmented_memory_ranges,
+                                           is_snapshot);
 
   if (::MiniDumpWriteDump(
-          target_process, base::GetProcId(target_process),
+          process_handle, process_id,
           destination_file.GetPlatformFile(), platform_minidump_type,
           dump_exception_pointers, &user_stream_information,
           const_cast<MINIDUMP_CALLBACK_INFORMATION*>(
@@ -284,4 +325,62 @@ bool GenerateMinidump(const base::FilePath& destination,
   return true;
 }
 
+}  // namespace
+
+DWORD GetRequiredAccessForMinidumpType(MinidumpRequest::Type type) {
+  return GetRequiredAccessForMinidumpTypeImpl(type ==
+                                              MinidumpRequest::FULL_DUMP_TYPE);
+}
+
+DWORD GetRequiredAccessForMinidumpType(api::MinidumpType type) {
+  return GetRequiredAccessForMinidumpTypeImpl(type == api::FULL_DUMP_TYPE);
+}
+
+bool GenerateMinidump(const base::FilePath& destination,
+                      base::ProcessHandle target_process,
+                      base::PlatformThreadId thread_id,
+                      const MinidumpRequest& request) {
+  return GenerateMinidumpImpl(destination, target_process,
+                              base::GetProcId(target_process), false,
+                              thread_id, request);
+}
+
+HANDLE CaptureProcessSnapshot(base::ProcessHandle target_process) {
+  static PssCaptureSnapshotFunc pss_capture_snapshot =
+      GetKernel32Function<PssCaptureSnapshotFunc>("PssCaptureSnapshot");
+  if (!pss_capture_snapshot)
+    return nullptr;
+
+  HPSS snapshot = nullptr;
+  DWORD error = pss_capture_snapshot(target_process, kSnapshotCaptureFlags,
+                                     CONTEXT_ALL, &snapshot);
+  if (error != ERROR_SUCCESS) {
+    LOG(ERROR) << "PssCaptureSnapshot failed: " << ::common::LogWe(error)
+               << ".";
+    return nullptr;
+  }
+  return reinterpret_cast<HANDLE>(snapshot);
+}
+
+void FreeProcessSnapshot(HANDLE snapshot) {
+  static PssFreeSnapshotFunc pss_free_snapshot =
+      GetKernel32Function<PssFreeSnapshotFunc>("PssFreeSnapshot");
+  DCHECK(pss_free_snapshot);
+  DWORD error =
+      pss_free_snapshot(::GetCurrentProcess(), reinterpret_cast<HPSS>(snapshot));
+  if (error != ERROR_SUCCESS)
+    LOG(ERROR) << "PssFreeSnapshot failed: " << ::common::LogWe(error) << ".";
+}
+
+bool GenerateMinidumpFromSnapshot(const base::FilePath& destination,
+                                  base::ProcessId process_id,
+                                  HANDLE snapshot,
+                                  base::PlatformThreadId thread_id,
+                                  const MinidumpRequest& request) {
+  DCHECK(snapshot);
+  DCHECK(!request.exception_info_address || request.client_exception_pointers);
+  return GenerateMinidumpImpl(destination, snapshot, process_id, true,
+                              thread_id, request);
+}
+
 }  // namespace kasko
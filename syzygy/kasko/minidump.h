@@ -48,6 +48,37 @@ bool GenerateMinidump(const base::FilePath& destination,
                       base::PlatformThreadId thread_id,
                       const MinidumpRequest& request);
 
+// Captures a snapshot of a process, from which a minidump may be generated
+// after the process has resumed. The threads of the process are only suspended
+// while the snapshot is taken, and its memory is cloned copy-on-write.
+// @param target_process The handle of the process to capture. Must have the
+//     access returned by GetRequiredAccessForMinidumpType.
+// @returns the snapshot, or null if snapshots aren't supported by the system
+//     or the capture fails. A non-null snapshot must be released with
+//     FreeProcessSnapshot.
+HANDLE CaptureProcessSnapshot(base::ProcessHandle target_process);
+
+// Releases a snapshot returned by CaptureProcessSnapshot.
+// @param snapshot The snapshot to release.
+void FreeProcessSnapshot(HANDLE snapshot);
+
+// Generates a minidump from a process snapshot. This behaves as
+// GenerateMinidump, with the exception pointers, the memory ranges and the
+// thread contexts read from the snapshot.
+// @param destination The path where the dump should be generated.
+// @param process_id The ID of the process that the snapshot was taken of.
+// @param snapshot A snapshot returned by CaptureProcessSnapshot.
+// @param thread_id The thread that threw the exception. Ignored if
+//     request.exception_pointers is null.
+// @param request The minidump parameters. request.exception_info_address must
+//     be null or valid in the client process.
+// @returns true if the operation is successful.
+bool GenerateMinidumpFromSnapshot(const base::FilePath& destination,
+                                  base::ProcessId process_id,
+                                  HANDLE snapshot,
+                                  base::PlatformThreadId thread_id,
+                                  const MinidumpRequest& request);
+
 }  // namespace kasko
 
 #endif  // SYZYGY_KASKO_MINIDUMP_H_
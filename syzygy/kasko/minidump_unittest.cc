@@ -36,6 +36,7 @@
 #include "base/strings/string_number_conversions.h"
 #include "base/strings/utf_string_conversions.h"
 #include "base/test/multiprocess_test.h"
+#include "base/win/windows_version.h"
 #include "gtest/gtest.h"
 #include "syzygy/kasko/loader_lock.h"
 #include "syzygy/kasko/minidump_request.h"
@@ -88,7 +89,7 @@ void ValidateMinidump(IDebugClient4* debug_client,
 
 class MinidumpTest : public ::testing::Test {
  public:
-  MinidumpTest() {}
+  MinidumpTest() : use_snapshot_(false) {}
 
   ~MinidumpTest() override {}
 
@@ -125,8 +126,17 @@ class MinidumpTest : public ::testing::Test {
       range = range.Offset(child_image_base -
                            reinterpret_cast<uint32_t>(&__ImageBase));
     }
-    *result = kasko::GenerateMinidump(dump_file_path, child_process.Handle(), 0,
-                                      adjusted_request);
+    if (use_snapshot_) {
+      HANDLE snapshot = CaptureProcessSnapshot(child_process.Handle());
+      ASSERT_TRUE(snapshot);
+      *result = GenerateMinidumpFromSnapshot(dump_file_path,
+                                             child_process.Pid(), snapshot, 0,
+                                             adjusted_request);
+      FreeProcessSnapshot(snapshot);
+    } else {
+      *result = kasko::GenerateMinidump(dump_file_path, child_process.Handle(),
+                                        0, adjusted_request);
+    }
 
     ASSERT_TRUE(child_process.Terminate(0, true));
   }
@@ -134,9 +144,11 @@ class MinidumpTest : public ::testing::Test {
  protected:
   base::FilePath temp_dir() { return temp_dir_.path(); }
   MinidumpRequest& request() { return request_; }
+  void set_use_snapshot(bool use_snapshot) { use_snapshot_ = use_snapshot; }
 
  private:
   MinidumpRequest request_;
+  bool use_snapshot_;
   base::ScopedTempDir temp_dir_;
   DISALLOW_COPY_AND_ASSIGN(MinidumpTest);
 };
@@ -152,6 +164,36 @@ TEST_F(MinidumpTest, GenerateAndLoad) {
       testing::VisitMinidump(dump_file_path, base::Bind(&ValidateMinidump)));
 }
 
+TEST_F(MinidumpTest, GenerateFromSnapshotAndLoad) {
+  // Process snapshots are only supported from Windows 8.1.
+  if (base::win::GetVersion() < base::win::VERSION_WIN8_1)
+    return;
+
+  set_use_snapshot(true);
+  base::FilePath dump_file_path = temp_dir().Append(L"test.dump");
+  MinidumpRequest::CustomStream custom_stream = {
+      kCustomStreamType, kCustomStreamContents, sizeof(kCustomStreamContents)};
+  request().custom_streams.push_back(custom_stream);
+  bool result = false;
+  ASSERT_NO_FATAL_FAILURE(CallGenerateMinidump(dump_file_path, &result));
+  ASSERT_TRUE(result);
+
+  ASSERT_HRESULT_SUCCEEDED(
+      testing::VisitMinidump(dump_file_path, base::Bind(&ValidateMinidump)));
+
+  // The custom stream is copied from the request, not from the snapshot.
+  base::MemoryMappedFile memory_mapped_file;
+  ASSERT_TRUE(memory_mapped_file.Initialize(dump_file_path));
+  MINIDUMP_DIRECTORY* dir = nullptr;
+  void* stream = nullptr;
+  ULONG stream_length = 0;
+  ASSERT_TRUE(::MiniDumpReadDumpStream(
+      const_cast<uint8_t*>(memory_mapped_file.data()), kCustomStreamType, &dir,
+      &stream, &stream_length));
+  ASSERT_EQ(sizeof(kCustomStreamContents), stream_length);
+  ASSERT_EQ(0, memcmp(stream, kCustomStreamContents, stream_length));
+}
+
 TEST_F(MinidumpTest, CustomStream) {
   // Generate a minidump for the current process.
   base::FilePath dump_file_path = temp_dir().Append(L"test.dump");
@@ -48,12 +48,24 @@
 // immediately upon detection. An orphaned crash keys file may occur normally in
 // the interval before the minidump file is moved. These files are only deleted
 // when their timestamp is more than a day in the past.
+//
+// Each upload attempt enumerates each subdirectory once, and pairs up the
+// report files from that listing. Within a subdirectory, reports are uploaded
+// least recently attempted first. When the repository is given a maximum size,
+// the reports least recently stored or attempted are deleted until the others
+// fit.
 
 #include "syzygy/kasko/report_repository.h"
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #include "base/logging.h"
 #include "base/files/file_enumerator.h"
 #include "base/files/file_util.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/kasko/crash_keys_serialization.h"
 
 namespace kasko {
@@ -154,100 +166,195 @@ base::FilePath GetDumpFileForCrashKeysFile(
   return crash_keys_path.ReplaceExtension(kDumpFileExtension);
 }
 
-// Returns a minidump that is eligible for upload from the given directory, if
-// any are.
-// @param directory The directory to scan.
-// @param maximum_timestamp_for_retries The cutoff for the most most recent
-//     upload attempt of eligible minidumps. If null, there is no cutoff.
-// @returns The path to a minidump that is eligible for upload, if any.
-base::FilePath GetPendingReportFromDirectory(
-    const base::FilePath& directory,
-    const base::Time& maximum_timestamp_for_retries) {
+// A queue of reports.
+struct Queue {
+  // The subdirectory holding the reports of the queue.
+  const base::char16* subdir;
+  // The subdirectory where the reports go after a failed upload, or nullptr if
+  // the failure is permanent.
+  const base::char16* failure_subdir;
+  // Whether the reports must wait for the retry interval between attempts.
+  bool waits_for_retry_interval;
+};
+
+// The queues, in the order their reports are uploaded.
+const Queue kQueues[] = {
+    {kIncomingReportsSubdir, kFailedOnceSubdir, false},
+    {kFailedOnceSubdir, kFailedTwiceSubdir, true},
+    {kFailedTwiceSubdir, nullptr, true}};
+
+// A report found in the repository.
+struct ReportInfo {
+  base::FilePath minidump_path;
+  // The index of the queue holding the report, in kQueues.
+  size_t queue;
+  // The last time the report was stored or attempted.
+  base::Time last_modified;
+  // The size of the minidump and the crash keys, in bytes.
+  int64_t size;
+};
+typedef std::vector<ReportInfo> ReportInfos;
+
+typedef std::map<base::FilePath, base::FileEnumerator::FileInfo> FileInfoMap;
+
+// @returns true if @p report1 was stored or attempted before @p report2.
+bool IsLessRecent(const ReportInfo& report1, const ReportInfo& report2) {
+  if (report1.last_modified != report2.last_modified)
+    return report1.last_modified < report2.last_modified;
+  return report1.minidump_path < report2.minidump_path;
+}
+
+// @returns true if @p report1 is uploaded before @p report2.
+bool IsUploadedBefore(const ReportInfo& report1, const ReportInfo& report2) {
+  if (report1.queue != report2.queue)
+    return report1.queue < report2.queue;
+  return IsLessRecent(report1, report2);
+}
+
+// Finds the reports of a queue, in a single pass over its directory. Deletes
+// the minidump files with missing crash keys, and optionally the crash keys
+// files with missing minidumps.
+// @param repository_path The directory where this repository stores reports.
+// @param queue The index of the queue to scan, in kQueues.
+// @param now The current time.
+// @param clean_orphaned_crash_keys Whether to delete the crash keys files with
+//     missing minidumps.
+// @param reports Receives the reports of the queue.
+void ScanQueue(const base::FilePath& repository_path,
+               size_t queue,
+               const base::Time& now,
+               bool clean_orphaned_crash_keys,
+               ReportInfos* reports) {
+  DCHECK_LT(queue, arraysize(kQueues));
+  DCHECK(reports);
+
+  FileInfoMap minidumps;
+  FileInfoMap crash_keys_files;
   base::FileEnumerator file_enumerator(
-      directory, false, base::FileEnumerator::FILES,
-      base::string16(L"*") + kDumpFileExtension);
-  // Visit all files in this directory until we find an eligible one.
+      repository_path.Append(kQueues[queue].subdir), false,
+      base::FileEnumerator::FILES);
   for (base::FilePath candidate = file_enumerator.Next(); !candidate.empty();
        candidate = file_enumerator.Next()) {
-    // Skip dumps with missing crash keys.
-    if (!base::PathExists(GetCrashKeysFileForDumpFile(candidate))) {
-      LOG(ERROR) << "Deleting a minidump file with missing crash keys: "
-                 << candidate.value();
-      LoggedDeleteFile(candidate);
+    if (candidate.MatchesExtension(kDumpFileExtension))
+      minidumps[candidate] = file_enumerator.GetInfo();
+    else if (candidate.MatchesExtension(kCrashKeysFileExtension))
+      crash_keys_files[candidate] = file_enumerator.GetInfo();
+  }
+
+  for (const auto& minidump : minidumps) {
+    base::FilePath crash_keys_path =
+        GetCrashKeysFileForDumpFile(minidump.first);
+    auto crash_keys = crash_keys_files.find(crash_keys_path);
+    if (crash_keys == crash_keys_files.end()) {
+      // Skip dumps with missing crash keys. The crash keys are written before
+      // the minidump is moved in, so unless they showed up after the scan this
+      // is an error.
+      if (!base::PathExists(crash_keys_path)) {
+        LOG(ERROR) << "Deleting a minidump file with missing crash keys: "
+                   << minidump.first.value();
+        LoggedDeleteFile(minidump.first);
+      }
       continue;
     }
-    if (maximum_timestamp_for_retries.is_null())
-      return candidate;
 
-    // Check if this file is eligible for retry.
-    base::FileEnumerator::FileInfo file_info = file_enumerator.GetInfo();
-    if (file_info.GetLastModifiedTime() <= maximum_timestamp_for_retries)
-      return candidate;
+    ReportInfo report = {
+        minidump.first, queue, minidump.second.GetLastModifiedTime(),
+        minidump.second.GetSize() + crash_keys->second.GetSize()};
+    reports->push_back(report);
+    crash_keys_files.erase(crash_keys);
   }
-  return base::FilePath();
-}
 
-void CleanOrphanedCrashKeysFiles(
-    const base::FilePath& repository_path,
-    const base::Time& now) {
+  if (!clean_orphaned_crash_keys)
+    return;
+
+  // We write crash keys files before moving dump files, so there is a brief
+  // period where an orphan might be expected. Only delete orphans that are
+  // more than a day old.
   base::Time one_day_ago(now - base::TimeDelta::FromDays(1));
-  const base::char16* subdirs[] = {
-      kIncomingReportsSubdir, kFailedOnceSubdir, kFailedTwiceSubdir};
-
-  for (size_t i = 0; i < arraysize(subdirs); ++i) {
-    base::FileEnumerator file_enumerator(
-        repository_path.Append(subdirs[i]), false, base::FileEnumerator::FILES,
-        base::string16(L"*") + kCrashKeysFileExtension);
-    for (base::FilePath candidate = file_enumerator.Next(); !candidate.empty();
-         candidate = file_enumerator.Next()) {
-      if (base::PathExists(GetDumpFileForCrashKeysFile(candidate)))
-        continue;
-
-      // We write crash keys files before moving dump files, so there is a brief
-      // period where an orphan might be expected. Only delete orphans that are
-      // more than a day old.
-      if (file_enumerator.GetInfo().GetLastModifiedTime() >= one_day_ago)
-        continue;
-
-      LOG(ERROR) << "Deleting a crash keys file with missing minidump: "
-                 << candidate.value();
-      LoggedDeleteFile(candidate);
+  for (const auto& crash_keys : crash_keys_files) {
+    if (crash_keys.second.GetLastModifiedTime() >= one_day_ago ||
+        base::PathExists(GetDumpFileForCrashKeysFile(crash_keys.first))) {
+      continue;
     }
+
+    LOG(ERROR) << "Deleting a crash keys file with missing minidump: "
+               << crash_keys.first.value();
+    LoggedDeleteFile(crash_keys.first);
+  }
+}
+
+// Deletes the least recently stored or attempted reports, until the others
+// fit in @p max_size bytes.
+// @param max_size The maximum total size of the reports.
+// @param reports The reports of the repository. On return, holds the reports
+//     that were kept.
+void EvictReports(int64_t max_size, ReportInfos* reports) {
+  DCHECK(reports);
+
+  int64_t total_size = 0;
+  for (const ReportInfo& report : *reports)
+    total_size += report.size;
+  if (total_size <= max_size)
+    return;
+
+  std::sort(reports->begin(), reports->end(), &IsLessRecent);
+  size_t evicted_count = 0;
+  while (evicted_count < reports->size() && total_size > max_size) {
+    const ReportInfo& report = (*reports)[evicted_count++];
+    LOG(WARNING) << "Evicting a report to bound the repository size: "
+                 << report.minidump_path.value();
+    LoggedDeleteFile(report.minidump_path);
+    LoggedDeleteFile(GetCrashKeysFileForDumpFile(report.minidump_path));
+    total_size -= report.size;
   }
+  reports->erase(reports->begin(), reports->begin() + evicted_count);
 }
 
-// Returns a minidump that is eligible for upload, if any are.
+// Returns the minidumps that are eligible for upload, if any are.
 // @param repository_path The directory where this repository stores reports.
 // @param now The current time.
 // @param retry_interval The minimum interval between upload attempts for a
 //     given report.
-// @returns A pair of mindump path (empty if none) and failure destination
-//     (empty if the next failure is permanent).
-std::pair<base::FilePath, base::FilePath> GetPendingReport(
+// @param max_size The maximum total size of the reports, or 0 for no limit.
+//     Only enforced when @p clean_up is true.
+// @param clean_up Whether to delete the orphaned and evicted report files.
+// @param max_count The maximum number of minidumps to return.
+// @param pending_reports Receives pairs of minidump path and failure
+//     destination (empty if the next failure is permanent), in upload order.
+void GetPendingReports(
     const base::FilePath& repository_path,
     const base::Time& now,
-    const base::TimeDelta& retry_interval) {
-  struct {
-    const base::char16* subdir;
-    const base::char16* failure_subdir;
-    base::Time retry_cutoff;
-  } directories[] = {
-      {kIncomingReportsSubdir, kFailedOnceSubdir, base::Time()},
-      {kFailedOnceSubdir, kFailedTwiceSubdir, now - retry_interval},
-      {kFailedTwiceSubdir, nullptr, now - retry_interval}};
-
-  for (size_t i = 0; i < arraysize(directories); ++i) {
-    base::FilePath result = GetPendingReportFromDirectory(
-        repository_path.Append(directories[i].subdir),
-        directories[i].retry_cutoff);
-    if (!result.empty()) {
-      if (!directories[i].failure_subdir)
-        return std::make_pair(result, base::FilePath());
-      return std::make_pair(
-          result, repository_path.Append(directories[i].failure_subdir));
-    }
+    const base::TimeDelta& retry_interval,
+    int64_t max_size,
+    bool clean_up,
+    size_t max_count,
+    std::vector<std::pair<base::FilePath, base::FilePath>>* pending_reports) {
+  DCHECK(pending_reports);
+  pending_reports->clear();
+
+  ReportInfos reports;
+  for (size_t i = 0; i < arraysize(kQueues); ++i)
+    ScanQueue(repository_path, i, now, clean_up, &reports);
+
+  if (clean_up && max_size != 0)
+    EvictReports(max_size, &reports);
+
+  std::sort(reports.begin(), reports.end(), &IsUploadedBefore);
+  base::Time retry_cutoff = now - retry_interval;
+  for (const ReportInfo& report : reports) {
+    if (pending_reports->size() == max_count)
+      break;
+
+    const Queue& queue = kQueues[report.queue];
+    if (queue.waits_for_retry_interval && report.last_modified > retry_cutoff)
+      continue;
+
+    base::FilePath failure_destination;
+    if (queue.failure_subdir)
+      failure_destination = repository_path.Append(queue.failure_subdir);
+    pending_reports->push_back(
+        std::make_pair(report.minidump_path, failure_destination));
   }
-  return std::pair<base::FilePath, base::FilePath>();
 }
 
 // Handles a non-permanent failure by moving the report files to a new queue.
@@ -294,6 +401,56 @@ void HandlePermanentFailure(const base::FilePath& minidump_path,
 
 }  // namespace
 
+// Uploads the pending reports, one per call to Run, until an upload fails.
+class ReportRepository::UploadDelegate
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  UploadDelegate(
+      ReportRepository* repository,
+      const base::Time& now,
+      const std::vector<std::pair<base::FilePath, base::FilePath>>& reports)
+      : repository_(repository),
+        now_(now),
+        reports_(reports),
+        next_report_(0),
+        failed_(false) {
+    DCHECK(repository);
+  }
+
+  void Run() override {
+    const std::pair<base::FilePath, base::FilePath>* report = nullptr;
+    {
+      base::AutoLock auto_lock(lock_);
+      // Back off until the next upload attempt after a failure.
+      if (failed_)
+        return;
+      DCHECK_LT(next_report_, reports_.size());
+      report = &reports_[next_report_++];
+    }
+
+    if (!repository_->UploadReport(report->first, report->second, now_)) {
+      base::AutoLock auto_lock(lock_);
+      failed_ = true;
+    }
+  }
+
+  // @returns true if no upload failed.
+  bool succeeded() {
+    base::AutoLock auto_lock(lock_);
+    return !failed_;
+  }
+
+ private:
+  ReportRepository* repository_;
+  base::Time now_;
+  const std::vector<std::pair<base::FilePath, base::FilePath>>& reports_;
+  base::Lock lock_;
+  size_t next_report_;  // Under lock_.
+  bool failed_;  // Under lock_.
+
+  DISALLOW_COPY_AND_ASSIGN(UploadDelegate);
+};
+
 ReportRepository::ReportRepository(
     const base::FilePath& repository_path,
     const base::TimeDelta& retry_interval,
@@ -304,7 +461,9 @@ ReportRepository::ReportRepository(
       retry_interval_(retry_interval),
       time_source_(time_source),
       uploader_(uploader),
-      permanent_failure_handler_(permanent_failure_handler) {
+      permanent_failure_handler_(permanent_failure_handler),
+      max_size_(0),
+      upload_worker_count_(1) {
 }
 
 ReportRepository::~ReportRepository() {
@@ -345,19 +504,48 @@ void ReportRepository::StoreReport(
 }
 
 bool ReportRepository::UploadPendingReport() {
+  return UploadPendingReports(1);
+}
+
+bool ReportRepository::UploadPendingReports(size_t max_count) {
+  DCHECK_LT(0U, max_count);
   base::Time now = time_source_.Run();
 
-  // Do a bit of opportunistic cleanup.
-  CleanOrphanedCrashKeysFiles(repository_path_, now);
+  // Do a bit of opportunistic cleanup along the way.
+  std::vector<std::pair<base::FilePath, base::FilePath>> pending_reports;
+  GetPendingReports(repository_path_, now, retry_interval_, max_size_, true,
+                    max_count, &pending_reports);
+  if (pending_reports.empty())
+    return true;  // Successful no-op.
 
-  std::pair<base::FilePath, base::FilePath> entry =
-      GetPendingReport(repository_path_, now, retry_interval_);
-  ScopedReportFile minidump_file(entry.first);
-  base::FilePath failure_destination = entry.second;
+  UploadDelegate delegate(this, now, pending_reports);
+  if (upload_worker_count_ == 1 || pending_reports.size() == 1) {
+    for (size_t i = 0; i < pending_reports.size(); ++i)
+      delegate.Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "ReportRepository",
+        static_cast<int>(
+            std::min(upload_worker_count_, pending_reports.size())));
+    pool.Start();
+    pool.AddWork(&delegate, static_cast<int>(pending_reports.size()));
+    pool.JoinAll();
+  }
 
-  if (minidump_file.Get().empty())
-    return true;  // Successful no-op.
+  return delegate.succeeded();
+}
 
+bool ReportRepository::HasPendingReports() {
+  std::vector<std::pair<base::FilePath, base::FilePath>> pending_reports;
+  GetPendingReports(repository_path_, time_source_.Run(), retry_interval_,
+                    max_size_, false, 1, &pending_reports);
+  return !pending_reports.empty();
+}
+
+bool ReportRepository::UploadReport(const base::FilePath& minidump_path,
+                                    const base::FilePath& failure_destination,
+                                    const base::Time& now) {
+  ScopedReportFile minidump_file(minidump_path);
   ScopedReportFile crash_keys_file(
       GetCrashKeysFileForDumpFile(minidump_file.Get()));
 
@@ -387,9 +575,4 @@ bool ReportRepository::UploadPendingReport() {
   return false;
 }
 
-bool ReportRepository::HasPendingReports() {
-  return !GetPendingReport(repository_path_, time_source_.Run(),
-                           retry_interval_).first.empty();
-}
-
 }  // namespace kasko
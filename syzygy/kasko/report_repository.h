@@ -15,8 +15,11 @@
 #ifndef SYZYGY_KASKO_REPORT_REPOSITORY_H_
 #define SYZYGY_KASKO_REPORT_REPOSITORY_H_
 
+#include <stdint.h>
 #include <map>
+
 #include "base/callback.h"
+#include "base/logging.h"
 #include "base/macros.h"
 #include "base/files/file_path.h"
 #include "base/strings/string16.h"
@@ -30,8 +33,11 @@ namespace kasko {
 //
 // Any number of ReportRepository instances may be used to store reports (via
 // StoreReport). Only a single instance should be used for uploading (via
-// UploadPendingReport). It's the client's responsibility to enforce this
-// requirement.
+// UploadPendingReport or UploadPendingReports). It's the client's
+// responsibility to enforce this requirement.
+//
+// The reports on disk are the only state: each upload attempt scans the
+// repository once, and uploads from that snapshot of the reports.
 class ReportRepository {
  public:
   // Attempts to upload the minidump at the specified file path with the given
@@ -81,15 +87,60 @@ class ReportRepository {
   //     uploaded.
   bool UploadPendingReport();
 
+  // Attempts to upload up to @p max_count pending reports, oldest first in
+  // each queue, with up to upload_worker_count() uploads at once. No further
+  // upload is started after a failure, so that an unreachable server doesn't
+  // push the whole backlog towards permanent failure at once.
+  // @param max_count The maximum number of reports to upload. Must be
+  //     positive.
+  // @returns true if there are no pending reports or all attempted uploads
+  //     succeeded.
+  bool UploadPendingReports(size_t max_count);
+
   // @returns true if UploadPendingReport would attempt to upload a report.
   bool HasPendingReports();
 
+  // @name Accessors and mutators.
+  // @{
+  // The maximum total size of the stored reports, in bytes, or 0 for no
+  // limit. When the reports exceed it, the ones least recently stored or
+  // attempted are deleted by the next upload attempt.
+  int64_t max_size() const { return max_size_; }
+  void set_max_size(int64_t max_size) {
+    DCHECK_LE(0, max_size);
+    max_size_ = max_size;
+  }
+
+  // The number of reports UploadPendingReports uploads at once. When greater
+  // than one, the uploader and the permanent failure handler are invoked from
+  // several threads at once, and must support it.
+  size_t upload_worker_count() const { return upload_worker_count_; }
+  void set_upload_worker_count(size_t upload_worker_count) {
+    DCHECK_LT(0U, upload_worker_count);
+    upload_worker_count_ = upload_worker_count;
+  }
+  // @}
+
  private:
+  class UploadDelegate;
+
+  // Attempts to upload a report, and handles its failure.
+  // @param minidump_path The path to the minidump of the report.
+  // @param failure_destination The directory where the report is moved on
+  //     failure, or empty if its next failure is permanent.
+  // @param now The current time.
+  // @returns true if the upload succeeded.
+  bool UploadReport(const base::FilePath& minidump_path,
+                    const base::FilePath& failure_destination,
+                    const base::Time& now);
+
   base::FilePath repository_path_;
   base::TimeDelta retry_interval_;
   TimeSource time_source_;
   Uploader uploader_;
   PermanentFailureHandler permanent_failure_handler_;
+  int64_t max_size_;
+  size_t upload_worker_count_;
 
   DISALLOW_COPY_AND_ASSIGN(ReportRepository);
 };
@@ -29,6 +29,7 @@
 #include "base/strings/string16.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/synchronization/lock.h"
 #include "base/time/time.h"
 #include "gtest/gtest.h"
 #include "syzygy/kasko/crash_keys_serialization.h"
@@ -148,6 +149,18 @@ class ReportRepositoryTest : public testing::Test {
     StoreReport(report);
   }
 
+  // Returns the total size of the files in the repository.
+  int64_t GetRepositorySize() {
+    int64_t size = 0;
+    base::FileEnumerator file_enumerator(repository_temp_dir_.path(), true,
+                                         base::FileEnumerator::FILES);
+    for (base::FilePath file = file_enumerator.Next(); !file.empty();
+         file = file_enumerator.Next()) {
+      size += file_enumerator.GetInfo().GetSize();
+    }
+    return size;
+  }
+
   // Returns the instance under test.
   ReportRepository* repository() { return repository_.get(); }
 
@@ -187,6 +200,9 @@ class ReportRepositoryTest : public testing::Test {
   // Implements the UploadHandler.
   bool Upload(const base::FilePath& minidump_path,
               const std::map<base::string16, base::string16>& crash_keys) {
+    // Uploads may be concurrent.
+    base::AutoLock auto_lock(lock_);
+
     Report report;
     bool success = base::ReadFileToString(minidump_path, &report.first);
     EXPECT_TRUE(success);
@@ -236,6 +252,8 @@ class ReportRepositoryTest : public testing::Test {
   // Implements the PermanentFailureHandler.
   void HandlePermanentFailure(const base::FilePath& minidump_path,
                               const base::FilePath& crash_keys_path) {
+    base::AutoLock auto_lock(lock_);
+
     Report report;
     EXPECT_TRUE(ReadCrashKeysFromFile(crash_keys_path, &report.second));
     ASSERT_TRUE(base::ReadFileToString(minidump_path, &report.first));
@@ -250,6 +268,9 @@ class ReportRepositoryTest : public testing::Test {
     }
   }
 
+  // Protects the expected reports from concurrent uploads.
+  base::Lock lock_;
+
   // If true, exactly one report should never have been sent (because we
   // corrupted it).
   bool remainder_expected_;
@@ -477,6 +498,63 @@ TEST_F(ReportRepositoryTest, MultipleInterleavedReports) {
   EXPECT_FALSE(repository()->HasPendingReports());
 }
 
+TEST_F(ReportRepositoryTest, BatchUploadTest) {
+  InjectForSuccessAfterRetries(0);
+  InjectForSuccessAfterRetries(0);
+  InjectForSuccessAfterRetries(0);
+
+  EXPECT_TRUE(repository()->HasPendingReports());
+  EXPECT_TRUE(repository()->UploadPendingReports(2));  // Succeeds twice
+  EXPECT_TRUE(repository()->HasPendingReports());
+  EXPECT_TRUE(repository()->UploadPendingReports(2));  // Succeeds
+  EXPECT_FALSE(repository()->HasPendingReports());
+  EXPECT_TRUE(repository()->UploadPendingReports(2));  // No-op
+}
+
+TEST_F(ReportRepositoryTest, BatchStopsAfterFailureTest) {
+  InjectForFailure();
+  InjectForFailure();
+  InjectForFailure();
+
+  // Each batch stops at its first failure.
+  for (size_t i = 0; i < 3; ++i) {
+    EXPECT_TRUE(repository()->HasPendingReports());
+    EXPECT_FALSE(repository()->UploadPendingReports(10));  // Fails
+  }
+  EXPECT_FALSE(repository()->HasPendingReports());
+
+  // Fail the retries, until the reports fail permanently.
+  for (size_t retry = 0; retry < 2; ++retry) {
+    IncrementTime(base::TimeDelta::FromSeconds(kRetryIntervalInSeconds));
+    for (size_t i = 0; i < 3; ++i)
+      EXPECT_FALSE(repository()->UploadPendingReports(10));  // Fails
+    EXPECT_FALSE(repository()->HasPendingReports());
+  }
+}
+
+TEST_F(ReportRepositoryTest, ConcurrentUploadTest) {
+  repository()->set_upload_worker_count(4);
+  for (size_t i = 0; i < 10; ++i)
+    InjectForSuccessAfterRetries(0);
+
+  EXPECT_TRUE(repository()->UploadPendingReports(10));  // Succeeds
+  EXPECT_FALSE(repository()->HasPendingReports());
+}
+
+TEST_F(ReportRepositoryTest, MaxSizeTest) {
+  InjectForSuccessAfterRetries(0);
+  IncrementTime(base::TimeDelta::FromSeconds(1));
+  InjectForSuccessAfterRetries(0);
+  InjectForSuccessAfterRetries(0);
+
+  // Only the oldest report doesn't fit.
+  repository()->set_max_size(GetRepositorySize() - 1);
+  EXPECT_TRUE(repository()->UploadPendingReports(10));  // Succeeds twice
+  EXPECT_FALSE(repository()->HasPendingReports());
+
+  SetRemainderExpected();
+}
+
 TEST_F(ReportRepositoryTest, CorruptionTest) {
   // In order to avoid hard-coding extensions/paths, and having a bunch of
   // permutations, let's run this test a bunch of times and probabilistically
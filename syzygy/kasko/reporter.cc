@@ -16,9 +16,11 @@
 
 #include <stdint.h>
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/bind.h"
 #include "base/bind_helpers.h"
@@ -29,6 +31,7 @@
 #include "base/process/process.h"
 #include "base/strings/utf_string_conversions.h"
 #include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
 #include "base/time/time.h"
 #include "syzygy/kasko/http_agent_impl.h"
 #include "syzygy/kasko/minidump.h"
@@ -50,6 +53,13 @@ const base::char16* const kRpcProtocol = L"ncalrpc";
 // The subdirectory where minidumps are generated.
 const base::char16* const kTemporarySubdir = L"Temporary";
 
+// The maximum number of reports uploaded each time the upload thread wakes up,
+// so that a backlog drains faster than one report per upload interval.
+const size_t kMaxUploadsPerWakeUp = 16;
+
+// The number of threads that write minidumps from process snapshots.
+const int kSnapshotWriterThreadCount = 2;
+
 // Moves |minidump_path| and |crash_keys_path| to |permanent_failure_directory|.
 // The destination filenames have the filename from |minidump_path| and the
 // extensions Reporter::kPermanentFailureMinidumpExtension and
@@ -79,29 +89,28 @@ void HandlePermanentFailure(const base::FilePath& permanent_failure_directory,
   }
 }
 
-void GenerateReport(const base::FilePath& temporary_directory,
-                    ReportRepository* report_repository,
-                    base::ProcessHandle client_process,
-                    base::PlatformThreadId thread_id,
-                    const MinidumpRequest& request) {
+// Creates an empty file in |temporary_directory| for a minidump to be written
+// to. Returns true on success.
+bool CreateDumpFile(const base::FilePath& temporary_directory,
+                    base::FilePath* dump_file) {
   if (!base::CreateDirectory(temporary_directory)) {
     LOG(ERROR) << "Failed to create dump destination directory: "
                << temporary_directory.value();
-    return;
+    return false;
   }
 
-  base::FilePath dump_file;
-  if (!base::CreateTemporaryFileInDir(temporary_directory, &dump_file)) {
+  if (!base::CreateTemporaryFileInDir(temporary_directory, dump_file)) {
     LOG(ERROR) << "Failed to create a temporary dump file.";
-    return;
-  }
-
-  if (!GenerateMinidump(dump_file, client_process, thread_id, request)) {
-    LOG(ERROR) << "Minidump generation failed.";
-    base::DeleteFile(dump_file, false);
-    return;
+    return false;
   }
+  return true;
+}
 
+// Stores |dump_file| in |report_repository|, along with the crash keys of
+// |request|.
+void StoreReport(const base::FilePath& dump_file,
+                 ReportRepository* report_repository,
+                 const MinidumpRequest& request) {
   std::map<base::string16, base::string16> crash_keys;
   for (auto& crash_key : request.crash_keys) {
     crash_keys[crash_key.first] = crash_key.second;
@@ -113,16 +122,110 @@ void GenerateReport(const base::FilePath& temporary_directory,
   report_repository->StoreReport(dump_file, crash_keys);
 }
 
+void GenerateReport(const base::FilePath& temporary_directory,
+                    ReportRepository* report_repository,
+                    base::ProcessHandle client_process,
+                    base::PlatformThreadId thread_id,
+                    const MinidumpRequest& request) {
+  base::FilePath dump_file;
+  if (!CreateDumpFile(temporary_directory, &dump_file))
+    return;
+
+  if (!GenerateMinidump(dump_file, client_process, thread_id, request)) {
+    LOG(ERROR) << "Minidump generation failed.";
+    base::DeleteFile(dump_file, false);
+    return;
+  }
+
+  StoreReport(dump_file, report_repository, request);
+}
+
+// A report whose minidump is written from a process snapshot on a worker
+// thread, after the client has been released. The request refers to storage
+// that belongs to the RPC call, so this keeps its own copies of the crash keys
+// and custom streams. Deletes itself once it has run.
+class SnapshotReport : public base::DelegateSimpleThread::Delegate {
+ public:
+  SnapshotReport(const base::FilePath& temporary_directory,
+                 ReportRepository* report_repository,
+                 UploadThread* upload_thread,
+                 base::ProcessId client_process_id,
+                 HANDLE snapshot,
+                 base::PlatformThreadId thread_id,
+                 const MinidumpRequest& request)
+      : temporary_directory_(temporary_directory),
+        report_repository_(report_repository),
+        upload_thread_(upload_thread),
+        client_process_id_(client_process_id),
+        snapshot_(snapshot),
+        thread_id_(thread_id),
+        request_(request) {
+    DCHECK(snapshot_);
+
+    for (const auto& crash_key : request.crash_keys) {
+      crash_key_storage_.push_back(crash_key.first);
+      crash_key_storage_.push_back(crash_key.second);
+    }
+    for (size_t i = 0; i < request_.crash_keys.size(); ++i) {
+      request_.crash_keys[i].first = crash_key_storage_[2 * i].c_str();
+      request_.crash_keys[i].second = crash_key_storage_[2 * i + 1].c_str();
+    }
+
+    for (auto& custom_stream : request_.custom_streams) {
+      const char* data = static_cast<const char*>(custom_stream.data);
+      custom_stream_storage_.push_back(
+          std::string(data, data + custom_stream.length));
+      custom_stream.data = custom_stream_storage_.back().data();
+    }
+  }
+
+  ~SnapshotReport() override { FreeProcessSnapshot(snapshot_); }
+
+  // base::DelegateSimpleThread::Delegate implementation.
+  void Run() override {
+    base::FilePath dump_file;
+    if (CreateDumpFile(temporary_directory_, &dump_file)) {
+      if (GenerateMinidumpFromSnapshot(dump_file, client_process_id_,
+                                       snapshot_, thread_id_, request_)) {
+        StoreReport(dump_file, report_repository_, request_);
+      } else {
+        LOG(ERROR) << "Minidump generation failed.";
+        base::DeleteFile(dump_file, false);
+      }
+    }
+    upload_thread_->UploadOneNowAsync();
+    delete this;
+  }
+
+ private:
+  base::FilePath temporary_directory_;
+  ReportRepository* report_repository_;
+  UploadThread* upload_thread_;
+  base::ProcessId client_process_id_;
+  HANDLE snapshot_;
+  base::PlatformThreadId thread_id_;
+  MinidumpRequest request_;
+
+  // The storage that |request_| refers to. A deque keeps the custom stream
+  // data in place as it grows.
+  std::vector<base::string16> crash_key_storage_;
+  std::deque<std::string> custom_stream_storage_;
+
+  DISALLOW_COPY_AND_ASSIGN(SnapshotReport);
+};
+
 // Implements kasko::Service to capture minidumps and store them in a
 // ReportRepository.
 class ServiceImpl : public Service {
  public:
   ServiceImpl(const base::FilePath& temporary_directory,
               ReportRepository* report_repository,
-              UploadThread* upload_thread)
+              UploadThread* upload_thread,
+              base::DelegateSimpleThreadPool* snapshot_writer_pool)
       : temporary_directory_(temporary_directory),
         report_repository_(report_repository),
-        upload_thread_(upload_thread) {}
+        upload_thread_(upload_thread),
+        snapshot_writer_pool_(snapshot_writer_pool) {}
 
   ~ServiceImpl() override {}
 
@@ -133,10 +236,29 @@ class ServiceImpl : public Service {
     base::win::ScopedHandle client_process(
         ::OpenProcess(GetRequiredAccessForMinidumpType(request.type), FALSE,
                       client_process_id));
-    if (client_process.IsValid()) {
-      GenerateReport(temporary_directory_, report_repository_,
-                     client_process.Get(), thread_id, request);
+    if (!client_process.IsValid()) {
+      upload_thread_->UploadOneNowAsync();
+      return;
     }
+
+    // Prefer capturing a snapshot, which only suspends the client for as long
+    // as the capture takes. The minidump is then written from the snapshot
+    // after the client has been released. Exception pointers in this process
+    // can't be read from a snapshot, so those requests are handled in full.
+    HANDLE snapshot = nullptr;
+    if (!request.exception_info_address || request.client_exception_pointers)
+      snapshot = CaptureProcessSnapshot(client_process.Get());
+    if (snapshot) {
+      snapshot_writer_pool_->AddWork(
+          new SnapshotReport(temporary_directory_, report_repository_,
+                             upload_thread_, client_process_id, snapshot,
+                             thread_id, request),
+          1);
+      return;
+    }
+
+    GenerateReport(temporary_directory_, report_repository_,
+                   client_process.Get(), thread_id, request);
     upload_thread_->UploadOneNowAsync();
   }
 
@@ -144,6 +266,7 @@ class ServiceImpl : public Service {
   base::FilePath temporary_directory_;
   ReportRepository* report_repository_;
   UploadThread* upload_thread_;
+  base::DelegateSimpleThreadPool* snapshot_writer_pool_;
 
   DISALLOW_COPY_AND_ASSIGN(ServiceImpl);
 };
@@ -187,8 +310,9 @@ std::unique_ptr<Reporter> Reporter::Create(
   // |report_repository|.
   std::unique_ptr<UploadThread> upload_thread = UploadThread::Create(
       data_directory, std::move(waitable_timer),
-      base::Bind(base::IgnoreResult(&ReportRepository::UploadPendingReport),
-                 base::Unretained(report_repository.get())));
+      base::Bind(base::IgnoreResult(&ReportRepository::UploadPendingReports),
+                 base::Unretained(report_repository.get()),
+                 kMaxUploadsPerWakeUp));
 
   if (!upload_thread) {
     LOG(ERROR) << "Failed to initialize background upload process.";
@@ -205,6 +329,7 @@ std::unique_ptr<Reporter> Reporter::Create(
   }
 
   instance->upload_thread_->Start();
+  instance->snapshot_writer_pool_->Start();
 
   return std::move(instance);
 }
@@ -223,6 +348,7 @@ void Reporter::SendReportForProcess(base::ProcessHandle process_handle,
 void Reporter::Shutdown(std::unique_ptr<Reporter> instance) {
   instance->upload_thread_->Stop();  // Non-blocking.
   instance->service_bridge_.Stop();  // Blocking.
+  instance->snapshot_writer_pool_->JoinAll();  // Blocking.
   instance->upload_thread_->Join();  // Blocking.
 }
 
@@ -265,12 +391,15 @@ Reporter::Reporter(std::unique_ptr<ReportRepository> report_repository,
     : report_repository_(std::move(report_repository)),
       upload_thread_(std::move(upload_thread)),
       temporary_minidump_directory_(temporary_minidump_directory),
+      snapshot_writer_pool_(new base::DelegateSimpleThreadPool(
+          "snapshot_writer", kSnapshotWriterThreadCount)),
       service_bridge_(
           kRpcProtocol,
           endpoint_name,
           base::WrapUnique(new ServiceImpl(temporary_minidump_directory_,
                                            report_repository_.get(),
-                                           upload_thread_.get()))) {
+                                           upload_thread_.get(),
+                                           snapshot_writer_pool_.get()))) {
 }
 
 }  // namespace kasko
@@ -28,6 +28,7 @@
 #include "syzygy/kasko/service_bridge.h"
 
 namespace base {
+class DelegateSimpleThreadPool;
 class TimeDelta;
 }  // namespace base
 
@@ -145,6 +146,10 @@ class Reporter {
   // The directory where minidumps will be initially created.
   base::FilePath temporary_minidump_directory_;
 
+  // The threads that write minidumps from the process snapshots captured by
+  // the RPC service. This must outlive |service_bridge_|.
+  std::unique_ptr<base::DelegateSimpleThreadPool> snapshot_writer_pool_;
+
   // An RPC service endpoint.
   ServiceBridge service_bridge_;
 
@@ -61,6 +61,11 @@ Minidump::TypedThreadExList Minidump::GetThreadExList() const {
   return TypedThreadExList(*this, ThreadExListStream);
 }
 
+const uint8_t* Minidump::GetBytes(size_t /* offset */,
+                                  size_t /* data_size */) const {
+  return nullptr;
+}
+
 bool Minidump::ReadDirectory() {
   // Read the header and validate the signature.
   MINIDUMP_HEADER header = {};
@@ -119,6 +124,7 @@ bool FileMinidump::ReadBytes(size_t offset,
                              size_t data_size,
                              void* data) const {
   DCHECK_LE(offset, static_cast<size_t>(std::numeric_limits<long>::max()));
+  base::AutoLock auto_lock(file_lock_);
   if (fseek(file_.get(), static_cast<long>(offset), SEEK_SET) != 0)
     return false;
 
@@ -143,16 +149,58 @@ bool BufferMinidump::Initialize(const uint8_t* buf, size_t buf_len) {
 bool BufferMinidump::ReadBytes(size_t offset,
                                size_t data_size,
                                void* data) const {
+  const uint8_t* bytes = GetBytes(offset, data_size);
+  if (bytes == nullptr)
+    return false;
+
+  ::memcpy(data, bytes, data_size);
+  return true;
+}
+
+const uint8_t* BufferMinidump::GetBytes(size_t offset,
+                                        size_t data_size) const {
   // Bounds check the request.
   if (offset >= buf_len_ || offset + data_size > buf_len_ ||
       offset + data_size < offset) {  // Test for overflow.
-    return false;
+    return nullptr;
   }
 
-  ::memcpy(data, buf_ + offset, data_size);
+  return buf_ + offset;
+}
+
+bool MappedMinidump::Open(const base::FilePath& path) {
+  if (!file_.Initialize(path))
+    return false;
+
+  return ReadDirectory();
+}
+
+bool MappedMinidump::ReadBytes(size_t offset,
+                               size_t data_size,
+                               void* data) const {
+  const uint8_t* bytes = GetBytes(offset, data_size);
+  if (bytes == nullptr)
+    return false;
+
+  ::memcpy(data, bytes, data_size);
   return true;
 }
 
+const uint8_t* MappedMinidump::GetBytes(size_t offset,
+                                        size_t data_size) const {
+  if (!file_.IsValid())
+    return nullptr;
+
+  // Bounds check the request.
+  size_t length = file_.length();
+  if (offset >= length || offset + data_size > length ||
+      offset + data_size < offset) {  // Test for overflow.
+    return nullptr;
+  }
+
+  return file_.data() + offset;
+}
+
 Minidump::Stream::Stream()
     : minidump_(nullptr),
       current_offset_(0),
@@ -222,6 +270,27 @@ bool Minidump::Stream::ReadBytes(size_t data_len, void* data) {
   return true;
 }
 
+bool Minidump::Stream::GetAndAdvanceBytes(size_t data_len,
+                                          const uint8_t** data) {
+  DCHECK(data != nullptr);
+
+  const uint8_t* bytes = GetBytes(data_len);
+  if (bytes == nullptr || !AdvanceBytes(data_len))
+    return false;
+
+  *data = bytes;
+  return true;
+}
+
+const uint8_t* Minidump::Stream::GetBytes(size_t data_len) const {
+  DCHECK(minidump_ != nullptr);
+
+  if (data_len > remaining_length_)
+    return nullptr;
+
+  return minidump_->GetBytes(current_offset_, data_len);
+}
+
 bool Minidump::Stream::AdvanceBytes(size_t data_len) {
   if (data_len > remaining_length_)
     return false;
@@ -26,7 +26,9 @@
 
 #include "base/macros.h"
 #include "base/files/file_path.h"
+#include "base/files/memory_mapped_file.h"
 #include "base/files/scoped_file.h"
+#include "base/synchronization/lock.h"
 
 namespace minidump {
 
@@ -112,6 +114,13 @@ class Minidump {
   // @returns true on success, false on failure, including a short read.
   virtual bool ReadBytes(size_t offset, size_t data_size, void* data) const = 0;
 
+  // Retrieves a pointer to file contents, for minidumps held in memory.
+  // @param offset the file offset of the contents.
+  // @param data_size the size of the contents.
+  // @returns a pointer to the contents, or nullptr if they're out of bounds or
+  //     the minidump isn't held in memory.
+  virtual const uint8_t* GetBytes(size_t offset, size_t data_size) const;
+
   bool ReadDirectory();
 
   std::vector<MINIDUMP_DIRECTORY> directory_;
@@ -132,7 +141,9 @@ class FileMinidump : public Minidump {
   bool ReadBytes(size_t offset, size_t data_size, void* data) const override;
 
  private:
-  base::ScopedFILE file_;
+  // Serializes the seek and read pairs of concurrent readers.
+  mutable base::Lock file_lock_;
+  base::ScopedFILE file_;  // Reads under file_lock_.
 };
 
 // Allows parsing a minidump from an in-memory buffer.
@@ -150,6 +161,7 @@ class BufferMinidump : public Minidump {
 
  protected:
   bool ReadBytes(size_t offset, size_t data_size, void* data) const override;
+  const uint8_t* GetBytes(size_t offset, size_t data_size) const override;
 
  private:
   // Not owned.
@@ -157,6 +169,25 @@ class BufferMinidump : public Minidump {
   size_t buf_len_;
 };
 
+// Allows parsing a minidump from a memory-mapped file. Its streams can hand
+// out pointers to the file contents rather than copies, which makes this the
+// fastest way to go through large minidumps. The whole file is mapped, so it
+// must fit in the address space of the process.
+class MappedMinidump : public Minidump {
+ public:
+  // Maps the minidump file at @p path and verifies its header structure.
+  // @param path the minidump file to map.
+  // @return true on success, false on failure.
+  bool Open(const base::FilePath& path);
+
+ protected:
+  bool ReadBytes(size_t offset, size_t data_size, void* data) const override;
+  const uint8_t* GetBytes(size_t offset, size_t data_size) const override;
+
+ private:
+  base::MemoryMappedFile file_;
+};
+
 // A forward-only reading class that bounds reads to streams that make it safe
 // and easy to parse minidump streams. Streams are lightweight objects that
 // can be freely copied.
@@ -187,6 +218,22 @@ class Minidump::Stream {
   bool AdvanceBytes(size_t data_len);
   // @}
 
+  // @name Functions that retrieve pointers to the data, and advance over it.
+  // These don't copy the data, and only succeed on minidumps held in memory.
+  // The data lives as long as the minidump.
+  // @{
+  bool GetAndAdvanceBytes(size_t data_len, const uint8_t** data);
+
+  // Retrieves a pointer to an array of @p count elements.
+  template <class DataType>
+  bool GetAndAdvanceElements(size_t count, const DataType** elements);
+  // @}
+
+  // Retrieves a pointer to the next @p data_len bytes, without advancing.
+  // @returns a pointer to the data, or nullptr if the stream is too short or
+  //     the minidump isn't held in memory.
+  const uint8_t* GetBytes(size_t data_len) const;
+
   // Accessors.
   size_t current_offset() const { return current_offset_; }
   size_t remaining_length() const { return remaining_length_; }
@@ -202,24 +249,26 @@ class Minidump::Stream {
 };
 
 // A forward only-iterator for Minidump Streams that yields elements of a
-// given, fixed type.
+// given, fixed type. On minidumps held in memory, the elements are yielded in
+// place, otherwise each element is read in turn.
 template <typename ElementType>
 class TypedMinidumpStreamIterator {
  public:
   // Creates a new iterator on @p stream. This iterator will yield
   // @p stream.GetBytesRemaining() / sizeof(ElementType) elements.
   explicit TypedMinidumpStreamIterator(const minidump::Minidump::Stream& stream)
-      : stream_(stream) {
+      : stream_(stream), current_(nullptr) {
     // Make sure the stream contains a range that covers whole elements.
     DCHECK(!stream_.IsValid() ||
            (stream.remaining_length() % sizeof(ElementType) == 0));
-    if (stream.remaining_length() != 0) {
-      // It's fatal if we can't pre-read the element that should be there.
-      CHECK(stream_.ReadBytes(sizeof(element_), &element_));
-    }
+    if (stream.remaining_length() != 0)
+      FetchElement();
   }
   TypedMinidumpStreamIterator(const TypedMinidumpStreamIterator& o)
-      : stream_(o.stream), element_(o.element_) {}
+      : stream_(o.stream_), element_(o.element_), current_(o.current_) {
+    if (current_ == &o.element_)
+      current_ = &element_;
+  }
 
   void operator++() {
     // It's invalid to advance the end iterator.
@@ -228,10 +277,9 @@ class TypedMinidumpStreamIterator {
     // It's fatal if we can't advance over the current element.
     CHECK(stream_.AdvanceBytes(sizeof(element_)));
 
-    if (stream_.remaining_length()) {
-      // Not yet at end, read the current element. Fatal if this fails.
-      CHECK(stream_.ReadBytes(sizeof(element_), &element_));
-    }
+    // Not yet at end, fetch the current element.
+    if (stream_.remaining_length())
+      FetchElement();
   }
 
   bool operator!=(const TypedMinidumpStreamIterator& o) const {
@@ -243,15 +291,29 @@ class TypedMinidumpStreamIterator {
 
   const ElementType& operator*() const {
     DCHECK_NE(0u, stream_.remaining_length());
-    return element_;
+    DCHECK(current_ != nullptr);
+    return *current_;
   }
 
  private:
   // Disallow default construction.
   TypedMinidumpStreamIterator() {}
 
+  // Points current_ to the element at the current position, in place if
+  // possible. It's fatal if the element that should be there can't be read.
+  void FetchElement() {
+    const uint8_t* data = stream_.GetBytes(sizeof(element_));
+    current_ = reinterpret_cast<const ElementType*>(data);
+    if (current_ == nullptr) {
+      CHECK(stream_.ReadBytes(sizeof(element_), &element_));
+      current_ = &element_;
+    }
+  }
+
   minidump::Minidump::Stream stream_;
   ElementType element_;
+  // Points to the current element, either in the minidump or to element_.
+  const ElementType* current_;
 };
 
 // A typed minidump stream allows reading a stream header and iterating over
@@ -274,6 +336,17 @@ class TypedMinidumpStream {
     return *reinterpret_cast<const HeaderType*>(header_storage_);
   }
 
+  // Retrieves the elements in place.
+  // @returns a pointer to the element_count() elements of the stream, or
+  //     nullptr if the minidump isn't held in memory or the stream is empty.
+  const ElementType* GetElements() const {
+    return reinterpret_cast<const ElementType*>(
+        element_stream_.GetBytes(element_stream_.remaining_length()));
+  }
+  size_t element_count() const {
+    return element_stream_.remaining_length() / sizeof(ElementType);
+  }
+
   Iterator begin() const { return Iterator(element_stream_); }
   Iterator end() const {
     return Iterator(Minidump::Stream(
@@ -342,6 +415,23 @@ bool Minidump::Stream::ReadAndAdvanceElement(DataType* element) {
   return ReadAndAdvanceBytes(sizeof(DataType), element);
 }
 
+template <typename DataType>
+bool Minidump::Stream::GetAndAdvanceElements(size_t count,
+                                             const DataType** elements) {
+  DCHECK(elements != nullptr);
+
+  // Guard against overflow of the byte size.
+  if (count > remaining_length_ / sizeof(DataType))
+    return false;
+
+  const uint8_t* data = nullptr;
+  if (!GetAndAdvanceBytes(count * sizeof(DataType), &data))
+    return false;
+
+  *elements = reinterpret_cast<const DataType*>(data);
+  return true;
+}
+
 }  // namespace minidump
 
 #endif  // SYZYGY_MINIDUMP_MINIDUMP_H_
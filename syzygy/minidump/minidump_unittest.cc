@@ -196,6 +196,60 @@ TEST_F(FileMinidumpTest, GetThreadExList) {
 }
 #endif
 
+TEST_F(FileMinidumpTest, MappedMinidumpMatchesFileMinidump) {
+  FileMinidump file_minidump;
+  MappedMinidump mapped_minidump;
+  ASSERT_TRUE(file_minidump.Open(testing::TestMinidumps::GetNotepad32Dump()));
+  ASSERT_TRUE(
+      mapped_minidump.Open(testing::TestMinidumps::GetNotepad32Dump()));
+  ASSERT_EQ(file_minidump.directory().size(),
+            mapped_minidump.directory().size());
+
+  auto file_memory = file_minidump.GetMemoryList();
+  auto mapped_memory = mapped_minidump.GetMemoryList();
+  ASSERT_TRUE(mapped_memory.IsValid());
+  ASSERT_EQ(file_memory.element_count(), mapped_memory.element_count());
+
+  // Only the mapped minidump hands out its elements in place.
+  EXPECT_EQ(nullptr, file_memory.GetElements());
+  const MINIDUMP_MEMORY_DESCRIPTOR* elements = mapped_memory.GetElements();
+  ASSERT_NE(nullptr, elements);
+
+  size_t i = 0;
+  for (const auto& element : file_memory) {
+    ASSERT_GT(mapped_memory.element_count(), i);
+    EXPECT_EQ(element.StartOfMemoryRange, elements[i].StartOfMemoryRange);
+    EXPECT_EQ(element.Memory.DataSize, elements[i].Memory.DataSize);
+
+    // The memory contents are the same.
+    Minidump::Stream file_stream = file_minidump.GetStreamFor(element.Memory);
+    Minidump::Stream mapped_stream =
+        mapped_minidump.GetStreamFor(elements[i].Memory);
+    std::string bytes;
+    const uint8_t* mapped_bytes = nullptr;
+    ASSERT_TRUE(file_stream.ReadAndAdvanceBytes(element.Memory.DataSize,
+                                                &bytes));
+    ASSERT_TRUE(mapped_stream.GetAndAdvanceBytes(element.Memory.DataSize,
+                                                 &mapped_bytes));
+    EXPECT_EQ(0U, mapped_stream.remaining_length());
+    EXPECT_EQ(0, ::memcmp(bytes.data(), mapped_bytes, bytes.size()));
+    ++i;
+  }
+  EXPECT_EQ(mapped_memory.element_count(), i);
+
+  // The iterator yields the elements in place.
+  i = 0;
+  for (const auto& element : mapped_memory)
+    EXPECT_EQ(&elements[i++], &element);
+}
+
+TEST_F(FileMinidumpTest, MappedMinidumpOpenFailsForInvalidFile) {
+  MappedMinidump minidump;
+
+  // Try mapping a non-existing file.
+  ASSERT_FALSE(minidump.Open(dump_file()));
+}
+
 TEST(BufferMinidumpTest, InitFailsForInvalidFile) {
   // Opening an empty buffer should fail.
   {
@@ -305,6 +359,51 @@ TEST(BufferMinidumpTest, StreamTest) {
   EXPECT_EQ(0, data[0]);
 }
 
+TEST(BufferMinidumpTest, GetAndAdvance) {
+  // Create a buffer with some data to test the streams.
+  ScopedMinidumpBuffer buf;
+
+  {
+    MINIDUMP_HEADER hdr = {0};
+    hdr.Signature = MINIDUMP_SIGNATURE;
+    hdr.NumberOfStreams = 1;
+    hdr.StreamDirectoryRva = sizeof(hdr);
+
+    buf.Append(hdr);
+
+    for (uint32_t i = 0; i < 100; ++i)
+      buf.Append(i);
+  }
+
+  BufferMinidump minidump;
+  ASSERT_TRUE(minidump.Initialize(buf.data(), buf.len()));
+
+  // Make a location covering three integers and a half.
+  MINIDUMP_LOCATION_DESCRIPTOR loc = { 14, sizeof(MINIDUMP_HEADER) };
+  Minidump::Stream test = minidump.GetStreamFor(loc);
+
+  // The data is handed out in place.
+  const uint32_t* elements = nullptr;
+  ASSERT_TRUE(test.GetAndAdvanceElements(2, &elements));
+  EXPECT_EQ(buf.data() + sizeof(MINIDUMP_HEADER),
+            reinterpret_cast<const uint8_t*>(elements));
+  EXPECT_EQ(0U, elements[0]);
+  EXPECT_EQ(1U, elements[1]);
+  EXPECT_EQ(6U, test.remaining_length());
+
+  // Getting elements past the end of the stream fails, and doesn't advance.
+  ASSERT_FALSE(test.GetAndAdvanceElements(2, &elements));
+  ASSERT_FALSE(test.GetAndAdvanceElements(static_cast<size_t>(-1), &elements));
+  EXPECT_EQ(6U, test.remaining_length());
+
+  const uint8_t* bytes = nullptr;
+  ASSERT_TRUE(test.GetAndAdvanceBytes(6, &bytes));
+  EXPECT_EQ(2U, bytes[0]);
+  EXPECT_EQ(3U, bytes[4]);
+  EXPECT_EQ(0U, test.remaining_length());
+  EXPECT_EQ(nullptr, test.GetBytes(1));
+}
+
 TEST(BufferMinidumpTest, ReadAndAdvanceString) {
   wchar_t kSomeString[] = L"some string";
 
@@ -41,6 +41,9 @@ class MsfByteStreamImpl : public MsfStreamImpl<T> {
   // @name MsfStreamImpl implementation.
   // @{
   bool ReadBytesAt(size_t pos, size_t count, void* dest) override;
+  bool GetViews(size_t pos,
+                size_t count,
+                std::vector<typename MsfStreamImpl<T>::View>* views) override;
   scoped_refptr<WritableMsfStreamImpl<T>> GetWritableStream() override;
   // @}
 
@@ -114,6 +114,25 @@ bool MsfByteStreamImpl<T>::ReadBytesAt(size_t pos, size_t count, void* dest) {
   return true;
 }
 
+template <MsfFileType T>
+bool MsfByteStreamImpl<T>::GetViews(
+    size_t pos,
+    size_t count,
+    std::vector<typename MsfStreamImpl<T>::View>* views) {
+  DCHECK(views != NULL);
+  views->clear();
+
+  if (pos > length() || count > length() - pos)
+    return false;
+
+  if (count > 0) {
+    typename MsfStreamImpl<T>::View view = {data() + pos, count};
+    views->push_back(view);
+  }
+
+  return true;
+}
+
 template <MsfFileType T>
 scoped_refptr<WritableMsfStreamImpl<T>>
 MsfByteStreamImpl<T>::GetWritableStream() {
@@ -17,21 +17,37 @@
 
 #include <stdio.h>
 
+#include <vector>
+
+#include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/msf/msf_decl.h"
 #include "syzygy/msf/msf_stream.h"
 
 namespace msf {
 
 // A reference counted FILE pointer object.
-// NOTE: This is not thread safe for a variety of reasons.
+// NOTE: The reference counting is not thread safe. Reads through the FILE
+//     should hold lock(), as streams sharing the file each seek it.
 class RefCountedFILE : public base::RefCounted<RefCountedFILE> {
  public:
   explicit RefCountedFILE(FILE* file) : file_(file) {}
 
+  // @param file the file pointer to reference count.
+  // @param path the path @p file was opened from.
+  RefCountedFILE(FILE* file, const base::FilePath& path)
+      : file_(file), path_(path) {}
+
   // @returns the file pointer being reference counted.
   FILE* file() { return file_; }
 
+  // @returns the path of the file, or an empty path if unknown.
+  const base::FilePath& path() const { return path_; }
+
+  // @returns the lock serializing accesses to the file.
+  base::Lock& lock() { return lock_; }
+
  private:
   friend base::RefCounted<RefCountedFILE>;
 
@@ -43,6 +59,8 @@ class RefCountedFILE : public base::RefCounted<RefCountedFILE> {
   }
 
   FILE* file_;
+  base::FilePath path_;
+  base::Lock lock_;
 
   DISALLOW_COPY_AND_ASSIGN(RefCountedFILE);
 };
@@ -66,8 +84,13 @@ class MsfFileStreamImpl : public MsfStreamImpl<T> {
                     const uint32_t* pages,
                     uint32_t page_size);
 
-  // MsfStreamImpl implementation.
+  // @name MsfStreamImpl implementation.
+  // @{
   bool ReadBytesAt(size_t pos, size_t count, void* dest) override;
+  bool GetFilePages(base::FilePath* path,
+                    uint32_t* page_size,
+                    std::vector<uint32_t>* pages) const override;
+  // @}
 
  protected:
   // Protected to enforce reference counted pointers at compile time.
@@ -49,6 +49,10 @@ bool MsfFileStreamImpl<T>::ReadBytesAt(size_t pos, size_t count, void* dest) {
   if (count > length() - pos)
     return false;
 
+  // The file is shared with the other streams of the MSF, which may be read
+  // concurrently.
+  base::AutoLock auto_lock(file_->lock());
+
   // Read the stream.
   while (count > 0) {
     size_t page_index = pos / page_size_;
@@ -65,6 +69,23 @@ bool MsfFileStreamImpl<T>::ReadBytesAt(size_t pos, size_t count, void* dest) {
   return true;
 }
 
+template <MsfFileType T>
+bool MsfFileStreamImpl<T>::GetFilePages(base::FilePath* path,
+                                        uint32_t* page_size,
+                                        std::vector<uint32_t>* pages) const {
+  DCHECK(path != NULL);
+  DCHECK(page_size != NULL);
+  DCHECK(pages != NULL);
+
+  if (file_->path().empty())
+    return false;
+
+  *path = file_->path();
+  *page_size = static_cast<uint32_t>(page_size_);
+  *pages = pages_;
+  return true;
+}
+
 template <MsfFileType T>
 bool MsfFileStreamImpl<T>::ReadFromPage(void* dest,
                                         uint32_t page_num,
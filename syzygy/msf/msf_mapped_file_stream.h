@@ -0,0 +1,132 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares an MSF stream that reads its pages straight out of a memory
+// mapping of the MSF file, rather than seeking and reading through a FILE.
+
+#ifndef SYZYGY_MSF_MSF_MAPPED_FILE_STREAM_H_
+#define SYZYGY_MSF_MSF_MAPPED_FILE_STREAM_H_
+
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/memory/ref_counted.h"
+#include "syzygy/msf/msf_decl.h"
+#include "syzygy/msf/msf_stream.h"
+
+namespace msf {
+
+// A reference counted read-only memory mapping of a whole file. Streams hold
+// a reference to it so that they can outlive the reader that created them.
+class RefCountedMappedFile : public base::RefCounted<RefCountedMappedFile> {
+ public:
+  RefCountedMappedFile() {}
+
+  // Maps the file at @p path.
+  // @param path the file to map.
+  // @returns true on success, false otherwise.
+  bool Initialize(const base::FilePath& path) {
+    if (!file_.Initialize(path))
+      return false;
+    path_ = path;
+    return true;
+  }
+
+  // @returns the path of the mapped file.
+  const base::FilePath& path() const { return path_; }
+
+  // @returns a pointer to the start of the mapping.
+  const uint8_t* data() const { return file_.data(); }
+
+  // @returns the size of the mapping, in bytes.
+  size_t length() const { return file_.length(); }
+
+ private:
+  friend base::RefCounted<RefCountedMappedFile>;
+
+  // We disallow access to the destructor to enforce the use of reference
+  // counting pointers.
+  ~RefCountedMappedFile() {}
+
+  base::MemoryMappedFile file_;
+  base::FilePath path_;
+
+  DISALLOW_COPY_AND_ASSIGN(RefCountedMappedFile);
+};
+
+namespace detail {
+
+// This class represents an MSF stream in a memory mapped file. Reads are
+// plain copies out of the mapping, and GetViews hands out pointers into it,
+// merging runs of consecutive pages into a single view.
+template <MsfFileType T>
+class MsfMappedFileStreamImpl : public MsfStreamImpl<T> {
+ public:
+  // Constructor.
+  // @param file the reference counted mapping housing this stream.
+  // @param length the length of this stream.
+  // @param pages the indices of the pages that make up this stream in the file.
+  //     A copy is made of the data so the pointer need not remain valid
+  //     beyond the constructor. The length of this array is implicit in the
+  //     stream length and the page size.
+  // @param page_size the size of the pages, in bytes.
+  MsfMappedFileStreamImpl(RefCountedMappedFile* file,
+                          uint32_t length,
+                          const uint32_t* pages,
+                          uint32_t page_size);
+
+  // @name MsfStreamImpl implementation.
+  // @{
+  bool ReadBytesAt(size_t pos, size_t count, void* dest) override;
+  bool GetViews(size_t pos,
+                size_t count,
+                std::vector<typename MsfStreamImpl<T>::View>* views) override;
+  bool GetFilePages(base::FilePath* path,
+                    uint32_t* page_size,
+                    std::vector<uint32_t>* pages) const override;
+  // @}
+
+ protected:
+  // Protected to enforce reference counted pointers at compile time.
+  virtual ~MsfMappedFileStreamImpl();
+
+  // Gets a pointer to @p offset bytes into page @p page_num of the mapping.
+  // @returns the pointer, or NULL if the @p count bytes at that location
+  //     don't lie entirely within the mapping.
+  const uint8_t* GetPageData(uint32_t page_num, size_t offset, size_t count);
+
+ private:
+  // The mapping of the MSF file.
+  scoped_refptr<RefCountedMappedFile> file_;
+
+  // The list of pages in the MSF that make up this stream.
+  std::vector<uint32_t> pages_;
+
+  // The size of pages within the stream.
+  size_t page_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MsfMappedFileStreamImpl);
+};
+
+}  // namespace detail
+
+using MsfMappedFileStream =
+    detail::MsfMappedFileStreamImpl<kGenericMsfFileType>;
+
+}  // namespace msf
+
+#include "syzygy/msf/msf_mapped_file_stream_impl.h"
+
+#endif  // SYZYGY_MSF_MSF_MAPPED_FILE_STREAM_H_
@@ -0,0 +1,146 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Internal implementation details for msf_mapped_file_stream.h. Not meant to
+// be included directly.
+
+#ifndef SYZYGY_MSF_MSF_MAPPED_FILE_STREAM_IMPL_H_
+#define SYZYGY_MSF_MSF_MAPPED_FILE_STREAM_IMPL_H_
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "syzygy/msf/msf_decl.h"
+
+namespace msf {
+namespace detail {
+
+template <MsfFileType T>
+MsfMappedFileStreamImpl<T>::MsfMappedFileStreamImpl(
+    RefCountedMappedFile* file,
+    uint32_t length,
+    const uint32_t* pages,
+    uint32_t page_size)
+    : MsfStreamImpl(length), file_(file), page_size_(page_size) {
+  DCHECK(file != NULL);
+  uint32_t num_pages = (length + page_size - 1) / page_size;
+  pages_.assign(pages, pages + num_pages);
+}
+
+template <MsfFileType T>
+MsfMappedFileStreamImpl<T>::~MsfMappedFileStreamImpl() {
+}
+
+template <MsfFileType T>
+bool MsfMappedFileStreamImpl<T>::ReadBytesAt(size_t pos,
+                                             size_t count,
+                                             void* dest) {
+  DCHECK(dest != NULL);
+
+  // Don't read beyond the end of the known stream length.
+  if (pos > length() || count > length() - pos)
+    return false;
+
+  while (count > 0) {
+    size_t page_index = pos / page_size_;
+    size_t offset = pos % page_size_;
+    size_t chunk_size = std::min(count, page_size_ - offset);
+    const uint8_t* src = GetPageData(pages_[page_index], offset, chunk_size);
+    if (src == NULL)
+      return false;
+    ::memcpy(dest, src, chunk_size);
+
+    count -= chunk_size;
+    pos += chunk_size;
+    dest = reinterpret_cast<uint8_t*>(dest) + chunk_size;
+  }
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfMappedFileStreamImpl<T>::GetViews(
+    size_t pos,
+    size_t count,
+    std::vector<typename MsfStreamImpl<T>::View>* views) {
+  DCHECK(views != NULL);
+  views->clear();
+
+  if (pos > length() || count > length() - pos)
+    return false;
+
+  while (count > 0) {
+    size_t page_index = pos / page_size_;
+    size_t offset = pos % page_size_;
+    size_t chunk_size = std::min(count, page_size_ - offset);
+    const uint8_t* src = GetPageData(pages_[page_index], offset, chunk_size);
+    if (src == NULL) {
+      views->clear();
+      return false;
+    }
+
+    // Pages that follow each other in the file extend the previous view.
+    if (!views->empty() && views->back().data + views->back().size == src) {
+      views->back().size += chunk_size;
+    } else {
+      typename MsfStreamImpl<T>::View view = {src, chunk_size};
+      views->push_back(view);
+    }
+
+    count -= chunk_size;
+    pos += chunk_size;
+  }
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfMappedFileStreamImpl<T>::GetFilePages(
+    base::FilePath* path,
+    uint32_t* page_size,
+    std::vector<uint32_t>* pages) const {
+  DCHECK(path != NULL);
+  DCHECK(page_size != NULL);
+  DCHECK(pages != NULL);
+
+  if (file_->path().empty())
+    return false;
+
+  *path = file_->path();
+  *page_size = static_cast<uint32_t>(page_size_);
+  *pages = pages_;
+  return true;
+}
+
+template <MsfFileType T>
+const uint8_t* MsfMappedFileStreamImpl<T>::GetPageData(uint32_t page_num,
+                                                       size_t offset,
+                                                       size_t count) {
+  DCHECK(offset + count <= page_size_);
+
+  // Page numbers come straight from the directory, so they can't be trusted.
+  uint64_t start = static_cast<uint64_t>(page_size_) * page_num + offset;
+  if (start + count > file_->length()) {
+    LOG(ERROR) << "Page " << page_num << " lies outside of the MSF file.";
+    return NULL;
+  }
+
+  return file_->data() + static_cast<size_t>(start);
+}
+
+}  // namespace detail
+}  // namespace msf
+
+#endif  // SYZYGY_MSF_MSF_MAPPED_FILE_STREAM_IMPL_H_
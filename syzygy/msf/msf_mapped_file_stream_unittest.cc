@@ -0,0 +1,109 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/msf/msf_mapped_file_stream.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/msf/msf_constants.h"
+#include "syzygy/msf/msf_data.h"
+#include "syzygy/msf/unittest_util.h"
+
+namespace msf {
+
+namespace {
+
+class MsfMappedFileStreamTest : public testing::Test {
+ public:
+  virtual void SetUp() {
+    file_ = new RefCountedMappedFile();
+    ASSERT_TRUE(file_->Initialize(
+        testing::GetSrcRelativePath(testing::kTestPdbFilePath)));
+  }
+
+ protected:
+  scoped_refptr<RefCountedMappedFile> file_;
+};
+
+}  // namespace
+
+TEST_F(MsfMappedFileStreamTest, Constructor) {
+  uint32_t pages[] = {1, 2, 3};
+  scoped_refptr<MsfMappedFileStream> stream(
+      new MsfMappedFileStream(file_.get(), 10, pages, 8));
+  EXPECT_EQ(10, stream->length());
+}
+
+TEST_F(MsfMappedFileStreamTest, ReadBytesAt) {
+  // Different sections of the MSF header magic string.
+  char* test_cases[] = {"Mic", "roso", "ft", " C/C+", "+ MS", "F 7.00"};
+
+  char buffer[8] = {0};
+  for (uint32_t page_size = 4; page_size <= 32; page_size *= 2) {
+    uint32_t pages[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    scoped_refptr<MsfMappedFileStream> stream(new MsfMappedFileStream(
+        file_.get(), sizeof(MsfHeader), pages, page_size));
+
+    size_t pos = 0;
+    for (uint32_t j = 0; j < arraysize(test_cases); ++j) {
+      char* test_case = test_cases[j];
+      size_t len = strlen(test_case);
+      EXPECT_TRUE(stream->ReadBytesAt(pos, len, &buffer));
+      EXPECT_EQ(0U, ::memcmp(buffer, test_case, len));
+      pos += len;
+    }
+
+    // Try a read past the end of the stream.
+    EXPECT_FALSE(stream->ReadBytesAt(sizeof(MsfHeader) - 1, 2, buffer));
+  }
+}
+
+TEST_F(MsfMappedFileStreamTest, ReadBytesAtPageOutsideOfFile) {
+  uint32_t pages[] = {0xFFFFFFF0};
+  scoped_refptr<MsfMappedFileStream> stream(
+      new MsfMappedFileStream(file_.get(), 4, pages, kMsfPageSize));
+  char buffer[4] = {0};
+  EXPECT_FALSE(stream->ReadBytesAt(0, 4, buffer));
+}
+
+TEST_F(MsfMappedFileStreamTest, GetViewsMergesConsecutivePages) {
+  // Pages 0 to 2 are consecutive, 5 isn't.
+  uint32_t pages[] = {0, 1, 2, 5};
+  const uint32_t kPageSize = 4;
+  scoped_refptr<MsfMappedFileStream> stream(
+      new MsfMappedFileStream(file_.get(), 16, pages, kPageSize));
+
+  std::vector<MsfMappedFileStream::View> views;
+  ASSERT_TRUE(stream->GetViews(1, 14, &views));
+  ASSERT_EQ(2u, views.size());
+  EXPECT_EQ(file_->data() + 1, views[0].data);
+  EXPECT_EQ(11u, views[0].size);
+  EXPECT_EQ(file_->data() + 5 * kPageSize, views[1].data);
+  EXPECT_EQ(3u, views[1].size);
+
+  // The views see the same bytes as a read.
+  char buffer[14] = {0};
+  ASSERT_TRUE(stream->ReadBytesAt(1, sizeof(buffer), buffer));
+  EXPECT_EQ(0, ::memcmp(buffer, views[0].data, views[0].size));
+  EXPECT_EQ(0, ::memcmp(buffer + views[0].size, views[1].data,
+                        views[1].size));
+
+  // An empty range yields no views, an out of bounds one fails.
+  EXPECT_TRUE(stream->GetViews(16, 0, &views));
+  EXPECT_TRUE(views.empty());
+  EXPECT_FALSE(stream->GetViews(10, 7, &views));
+  EXPECT_TRUE(views.empty());
+}
+
+}  // namespace msf
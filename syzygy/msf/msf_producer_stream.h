@@ -0,0 +1,79 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares an MSF stream whose contents are produced on demand by a callback.
+// This lets a stream of known length be added to an MSF file without being
+// materialized in memory; the writer pulls it page run by page run.
+
+#ifndef SYZYGY_MSF_MSF_PRODUCER_STREAM_H_
+#define SYZYGY_MSF_MSF_PRODUCER_STREAM_H_
+
+#include "base/callback.h"
+#include "base/logging.h"
+#include "syzygy/msf/msf_decl.h"
+#include "syzygy/msf/msf_stream.h"
+
+namespace msf {
+namespace detail {
+
+template <MsfFileType T>
+class MsfProducerStreamImpl : public MsfStreamImpl<T> {
+ public:
+  // Produces @p count bytes of the stream starting at @p pos into @p dest.
+  // This may be invoked any number of times, for any range of the stream, and
+  // from a writer thread; it must produce the same bytes every time.
+  // @returns true on success, false otherwise.
+  typedef base::Callback<bool(size_t pos, size_t count, void* dest)>
+      ProduceCallback;
+
+  // Constructor.
+  // @param length the length of the stream.
+  // @param produce the callback producing the contents of the stream.
+  MsfProducerStreamImpl(uint32_t length, const ProduceCallback& produce)
+      : MsfStreamImpl(length), produce_(produce) {
+    DCHECK(!produce_.is_null());
+  }
+
+  // @name MsfStreamImpl implementation.
+  // @{
+  bool ReadBytesAt(size_t pos, size_t count, void* dest) override {
+    DCHECK(dest != NULL);
+
+    // Don't read beyond the end of the known stream length.
+    if (pos > length() || count > length() - pos)
+      return false;
+    if (count == 0)
+      return true;
+
+    return produce_.Run(pos, count, dest);
+  }
+  // @}
+
+ protected:
+  // Protected to enforce reference counted pointers at compile time.
+  virtual ~MsfProducerStreamImpl() {}
+
+ private:
+  ProduceCallback produce_;
+
+  DISALLOW_COPY_AND_ASSIGN(MsfProducerStreamImpl);
+};
+
+}  // namespace detail
+
+using MsfProducerStream = detail::MsfProducerStreamImpl<kGenericMsfFileType>;
+
+}  // namespace msf
+
+#endif  // SYZYGY_MSF_MSF_PRODUCER_STREAM_H_
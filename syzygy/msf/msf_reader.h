@@ -22,6 +22,7 @@
 #include "syzygy/msf/msf_decl.h"
 #include "syzygy/msf/msf_file.h"
 #include "syzygy/msf/msf_file_stream.h"
+#include "syzygy/msf/msf_mapped_file_stream.h"
 #include "syzygy/msf/msf_stream.h"
 
 namespace msf {
@@ -46,7 +47,61 @@ class MsfReaderImpl {
   // @returns true on success, false otherwise.
   bool Read(const base::FilePath& msf_path, MsfFileImpl<T>* msf_file);
 
+  // Reads an MSF through a memory mapping of the whole file, populating the
+  // given MsfFileImpl object with streams that read straight out of the
+  // mapping and support MsfStreamImpl::GetViews. Nothing but the directory is
+  // read up front, so this is much cheaper than Read when only a few streams
+  // of a large file are of interest. Falls back to Read if the file can't be
+  // mapped, e.g. for lack of address space.
+  //
+  // @param msf_path the MSF file to read.
+  // @param msf_file the empty MsfFileImpl object to be filled in.
+  // @returns true on success, false otherwise.
+  bool ReadMapped(const base::FilePath& msf_path, MsfFileImpl<T>* msf_file);
+
+  // Reads a single stream of an MSF. Only the header and the parts of the
+  // directory needed to locate the stream are read, so this is much cheaper
+  // than Read for probing a file, e.g. for the signature of a PDB.
+  //
+  // @param msf_path the MSF file to read.
+  // @param stream_index the index of the stream to read.
+  // @param stream receives the stream, whose contents are read on demand.
+  // @returns true on success, false if the file is invalid or has no stream
+  //     at @p stream_index.
+  bool ReadStream(const base::FilePath& msf_path,
+                  uint32_t stream_index,
+                  scoped_refptr<MsfStreamImpl<T>>* stream);
+
  private:
+  // Parses the header of an MSF and creates a stream over its directory.
+  // @tparam StreamType the type of stream to create. Must be constructible
+  //     from (FileType*, length, pages, page_size).
+  // @tparam FileType the type of the backing file.
+  // @param file the backing file.
+  // @param file_size the size of the backing file, in bytes.
+  // @param header receives the header of the MSF.
+  // @param dir_stream receives the directory stream.
+  // @returns true on success, false otherwise.
+  template <typename StreamType, typename FileType>
+  static bool ReadDirectory(FileType* file,
+                            uint32_t file_size,
+                            MsfHeader* header,
+                            scoped_refptr<StreamType>* dir_stream);
+
+  // Parses the header and directory of an MSF and appends its streams to
+  // @p msf_file.
+  // @tparam StreamType the type of stream to create. Must be constructible
+  //     from (FileType*, length, pages, page_size).
+  // @tparam FileType the type of the backing file.
+  // @param file the backing file.
+  // @param file_size the size of the backing file, in bytes.
+  // @param msf_file the empty MsfFileImpl object to be filled in.
+  // @returns true on success, false otherwise.
+  template <typename StreamType, typename FileType>
+  static bool ReadStreams(FileType* file,
+                          uint32_t file_size,
+                          MsfFileImpl<T>* msf_file);
+
   DISALLOW_COPY_AND_ASSIGN(MsfReaderImpl);
 };
 
@@ -68,7 +68,7 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
   msf_file->Clear();
 
   scoped_refptr<RefCountedFILE> file(
-      new RefCountedFILE(base::OpenFile(msf_path, "rb")));
+      new RefCountedFILE(base::OpenFile(msf_path, "rb"), msf_path));
   if (!file->file()) {
     LOG(ERROR) << "Unable to open '" << msf_path.value() << "'.";
     return false;
@@ -81,26 +81,125 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
     return false;
   }
 
+  return ReadStreams<MsfFileStreamImpl<T>>(file.get(), file_size, msf_file);
+}
+
+template <MsfFileType T>
+bool MsfReaderImpl<T>::ReadMapped(const base::FilePath& msf_path,
+                                  MsfFileImpl<T>* msf_file) {
+  DCHECK(msf_file != NULL);
+
+  msf_file->Clear();
+
+  scoped_refptr<RefCountedMappedFile> file(new RefCountedMappedFile());
+  if (!file->Initialize(msf_path)) {
+    LOG(WARNING) << "Unable to map '" << msf_path.value()
+                 << "', falling back to buffered reads.";
+    return Read(msf_path, msf_file);
+  }
+
+  if (static_cast<uint64_t>(file->length()) > 0xFFFFFFFFu) {
+    LOG(ERROR) << "Invalid MSF file size.";
+    return false;
+  }
+
+  return ReadStreams<MsfMappedFileStreamImpl<T>>(
+      file.get(), static_cast<uint32_t>(file->length()), msf_file);
+}
+
+template <MsfFileType T>
+bool MsfReaderImpl<T>::ReadStream(const base::FilePath& msf_path,
+                                  uint32_t stream_index,
+                                  scoped_refptr<MsfStreamImpl<T>>* stream) {
+  DCHECK(stream != NULL);
+
+  *stream = NULL;
+
+  scoped_refptr<RefCountedFILE> file(
+      new RefCountedFILE(base::OpenFile(msf_path, "rb"), msf_path));
+  if (!file->file()) {
+    LOG(ERROR) << "Unable to open '" << msf_path.value() << "'.";
+    return false;
+  }
+
+  uint32_t file_size = 0;
+  if (!GetFileSize(file->file(), &file_size)) {
+    LOG(ERROR) << "Unable to determine size of '" << msf_path.value() << "'.";
+    return false;
+  }
+
   MsfHeader header = {0};
+  scoped_refptr<MsfFileStreamImpl<T>> dir_stream;
+  if (!ReadDirectory(file.get(), file_size, &header, &dir_stream))
+    return false;
+
+  uint32_t num_streams = 0;
+  if (!dir_stream->ReadBytesAt(0, sizeof(num_streams), &num_streams)) {
+    LOG(ERROR) << "Failed to read directory stream.";
+    return false;
+  }
+  if (stream_index >= num_streams) {
+    LOG(ERROR) << "MSF file has no stream " << stream_index << ".";
+    return false;
+  }
+
+  // The pages of the stream follow those of the streams before it, so only
+  // the lengths up to its own are needed to locate them.
+  std::vector<uint32_t> stream_lengths(stream_index + 1);
+  if (!dir_stream->ReadBytesAt(sizeof(uint32_t),
+                               stream_lengths.size() * sizeof(uint32_t),
+                               &stream_lengths[0])) {
+    LOG(ERROR) << "Failed to read directory stream.";
+    return false;
+  }
+
+  size_t page_index = 1 + num_streams;
+  for (uint32_t i = 0; i < stream_index; ++i)
+    page_index += GetNumPages(header, stream_lengths[i]);
+
+  std::vector<uint32_t> stream_pages(
+      GetNumPages(header, stream_lengths[stream_index]));
+  if (!stream_pages.empty() &&
+      !dir_stream->ReadBytesAt(page_index * sizeof(uint32_t),
+                               stream_pages.size() * sizeof(uint32_t),
+                               &stream_pages[0])) {
+    LOG(ERROR) << "Failed to read directory stream.";
+    return false;
+  }
+
+  *stream = new MsfFileStreamImpl<T>(file.get(), stream_lengths[stream_index],
+                                     stream_pages.data(), header.page_size);
+  return true;
+}
+
+template <MsfFileType T>
+template <typename StreamType, typename FileType>
+bool MsfReaderImpl<T>::ReadDirectory(FileType* file,
+                                     uint32_t file_size,
+                                     MsfHeader* header,
+                                     scoped_refptr<StreamType>* dir_stream) {
+  DCHECK(file != NULL);
+  DCHECK(header != NULL);
+  DCHECK(dir_stream != NULL);
 
   // Read the header from the first page in the file. The page size we use here
   // is irrelevant as after reading the header we get the actual page size in
   // use by the MSF and from then on use that.
   uint32_t header_page = 0;
-  scoped_refptr<MsfFileStreamImpl<T>> header_stream(new MsfFileStreamImpl<T>(
-      file.get(), sizeof(header), &header_page, kMsfPageSize));
-  if (!header_stream->ReadBytesAt(0, sizeof(header), &header)) {
+  scoped_refptr<StreamType> header_stream(
+      new StreamType(file, sizeof(*header), &header_page, kMsfPageSize));
+  if (!header_stream->ReadBytesAt(0, sizeof(*header), header)) {
     LOG(ERROR) << "Failed to read MSF file header.";
     return false;
   }
 
   // Sanity checks.
-  if (header.num_pages * header.page_size != file_size) {
+  if (header->num_pages * header->page_size != file_size) {
     LOG(ERROR) << "Invalid MSF file size.";
     return false;
   }
 
-  if (memcmp(header.magic_string, kMsfHeaderMagicString,
+  if (memcmp(header->magic_string, kMsfHeaderMagicString,
              sizeof(kMsfHeaderMagicString)) != 0) {
     LOG(ERROR) << "Invalid MSF magic string.";
     return false;
@@ -111,10 +210,10 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
   // many pages are required to represent the directory, then we load a stream
   // containing that many page pointers from the root pages array.
   int num_dir_pages =
-      static_cast<int>(GetNumPages(header, header.directory_size));
-  scoped_refptr<MsfFileStreamImpl<T>> dir_page_stream(
-      new MsfFileStreamImpl<T>(file.get(), num_dir_pages * sizeof(uint32_t),
-                               header.root_pages, header.page_size));
+      static_cast<int>(GetNumPages(*header, header->directory_size));
+  scoped_refptr<StreamType> dir_page_stream(
+      new StreamType(file, num_dir_pages * sizeof(uint32_t),
+                     header->root_pages, header->page_size));
   std::unique_ptr<uint32_t[]> dir_pages(new uint32_t[num_dir_pages]);
   if (dir_pages.get() == NULL) {
     LOG(ERROR) << "Failed to allocate directory pages.";
@@ -126,11 +225,27 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
     return false;
   }
 
+  *dir_stream = new StreamType(file, header->directory_size, dir_pages.get(),
+                               header->page_size);
+  return true;
+}
+
+template <MsfFileType T>
+template <typename StreamType, typename FileType>
+bool MsfReaderImpl<T>::ReadStreams(FileType* file,
+                                   uint32_t file_size,
+                                   MsfFileImpl<T>* msf_file) {
+  DCHECK(file != NULL);
+  DCHECK(msf_file != NULL);
+
+  MsfHeader header = {0};
+  scoped_refptr<StreamType> dir_stream;
+  if (!ReadDirectory(file, file_size, &header, &dir_stream))
+    return false;
+
   // Load the actual directory.
   size_t dir_size =
       static_cast<size_t>(header.directory_size / sizeof(uint32_t));
-  scoped_refptr<MsfFileStreamImpl<T>> dir_stream(new MsfFileStreamImpl<T>(
-      file.get(), header.directory_size, dir_pages.get(), header.page_size));
   std::vector<uint32_t> directory(dir_size);
   if (!dir_stream->ReadBytesAt(0, dir_size * sizeof(uint32_t), &directory[0])) {
     LOG(ERROR) << "Failed to read directory stream.";
@@ -145,8 +260,8 @@ bool MsfReaderImpl<T>::Read(const base::FilePath& msf_path,
   uint32_t page_index = 0;
   for (uint32_t stream_index = 0; stream_index < num_streams; ++stream_index) {
     msf_file->AppendStream(
-        new MsfFileStreamImpl<T>(file.get(), stream_lengths[stream_index],
-                                 stream_pages + page_index, header.page_size));
+        new StreamType(file, stream_lengths[stream_index],
+                       stream_pages + page_index, header.page_size));
     page_index += GetNumPages(header, stream_lengths[stream_index]);
   }
 
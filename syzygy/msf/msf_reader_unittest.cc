@@ -32,4 +32,59 @@ TEST(MsfReaderTest, Read) {
   EXPECT_EQ(msf_file.StreamCount(), 168u);
 }
 
+TEST(MsfReaderTest, ReadMapped) {
+  base::FilePath test_dll_msf =
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath);
+
+  MsfReader reader;
+  MsfFile msf_file;
+  MsfFile mapped_msf_file;
+  ASSERT_TRUE(reader.Read(test_dll_msf, &msf_file));
+  ASSERT_TRUE(reader.ReadMapped(test_dll_msf, &mapped_msf_file));
+  EXPECT_EQ(168u, mapped_msf_file.StreamCount());
+
+  testing::EnsureMsfContentsAreIdentical(msf_file, mapped_msf_file);
+
+  // Mapped streams can be viewed without copying.
+  std::vector<MsfStream::View> views;
+  scoped_refptr<MsfStream> stream = mapped_msf_file.GetStream(1);
+  ASSERT_TRUE(stream.get() != NULL);
+  EXPECT_TRUE(stream->GetViews(0, stream->length(), &views));
+  EXPECT_FALSE(views.empty());
+}
+
+TEST(MsfReaderTest, ReadStream) {
+  base::FilePath test_dll_msf =
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath);
+
+  MsfReader reader;
+  MsfFile msf_file;
+  ASSERT_TRUE(reader.Read(test_dll_msf, &msf_file));
+
+  // Each stream read on its own matches the one read with the whole file.
+  for (uint32_t i = 0; i < msf_file.StreamCount(); ++i) {
+    scoped_refptr<MsfStream> expected_stream = msf_file.GetStream(i);
+    ASSERT_TRUE(expected_stream.get() != NULL);
+
+    scoped_refptr<MsfStream> stream;
+    ASSERT_TRUE(reader.ReadStream(test_dll_msf, i, &stream));
+    ASSERT_TRUE(stream.get() != NULL);
+    ASSERT_EQ(expected_stream->length(), stream->length());
+
+    std::vector<uint8_t> expected_data(expected_stream->length());
+    std::vector<uint8_t> data(stream->length());
+    if (data.empty())
+      continue;
+    ASSERT_TRUE(expected_stream->ReadBytesAt(0, expected_data.size(),
+                                             &expected_data[0]));
+    ASSERT_TRUE(stream->ReadBytesAt(0, data.size(), &data[0]));
+    EXPECT_EQ(expected_data, data);
+  }
+
+  scoped_refptr<MsfStream> stream;
+  EXPECT_FALSE(reader.ReadStream(
+      test_dll_msf, static_cast<uint32_t>(msf_file.StreamCount()), &stream));
+  EXPECT_TRUE(stream.get() == NULL);
+}
+
 }  // namespace msf
@@ -15,7 +15,10 @@
 #ifndef SYZYGY_MSF_MSF_STREAM_H_
 #define SYZYGY_MSF_MSF_STREAM_H_
 
+#include <vector>
+
 #include "base/logging.h"
+#include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
 #include "syzygy/common/buffer_writer.h"
 #include "syzygy/msf/msf_decl.h"
@@ -32,6 +35,14 @@ class WritableMsfStreamImpl;
 template <MsfFileType T>
 class MsfStreamImpl : public base::RefCounted<MsfStreamImpl<T>> {
  public:
+  // A contiguous run of stream data that lives in memory owned by the
+  // stream. It remains valid for as long as the stream is alive and isn't
+  // written to.
+  struct View {
+    const uint8_t* data;
+    size_t size;
+  };
+
   explicit MsfStreamImpl(uint32_t length);
 
   // Reads @p count bytes of data starting at @p pos into the destination
@@ -44,6 +55,37 @@ class MsfStreamImpl : public base::RefCounted<MsfStreamImpl<T>> {
   // @returns true if all @p count bytes are read, false otherwise.
   virtual bool ReadBytesAt(size_t pos, size_t count, void* dest) = 0;
 
+  // Gets views onto the @p count bytes of data starting at @p pos, without
+  // copying them. Adjacent pieces of data are returned as a single view, so a
+  // range that is contiguous in the backing store yields exactly one view.
+  //
+  // @param pos the position in the stream of the first byte to view.
+  // @param count the number of bytes to view.
+  // @param views receives the views, in stream order. Cleared first.
+  // @returns true on success, false if the range is out of bounds or if the
+  //     stream doesn't hold its data in memory. The default implementation
+  //     always returns false; callers should fall back to ReadBytesAt.
+  virtual bool GetViews(size_t pos, size_t count, std::vector<View>* views) {
+    DCHECK_NE(static_cast<std::vector<View>*>(nullptr), views);
+    views->clear();
+    return false;
+  }
+
+  // Gets the pages of the MSF file on disk that hold the data of this stream,
+  // if the stream is an unmodified view of them. This lets a writer updating
+  // that file keep the stream where it is.
+  //
+  // @param path receives the path of the MSF file.
+  // @param page_size receives the page size of the MSF file.
+  // @param pages receives the pages holding the stream, in stream order.
+  // @returns true if the stream is backed by pages of an MSF file, false
+  //     otherwise. The default implementation always returns false.
+  virtual bool GetFilePages(base::FilePath* path,
+                            uint32_t* page_size,
+                            std::vector<uint32_t>* pages) const {
+    return false;
+  }
+
   // Returns a pointer to a WritableMsfStreamImpl if the underlying object
   // supports this interface. If this returns non-NULL, it is up to the user to
   // ensure thread safety; each writer should be used exclusively of any other
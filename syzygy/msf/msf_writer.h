@@ -18,8 +18,12 @@
 #ifndef SYZYGY_MSF_MSF_WRITER_H_
 #define SYZYGY_MSF_MSF_WRITER_H_
 
+#include <vector>
+
+#include "base/files/file.h"
 #include "base/files/file_path.h"
 #include "base/files/file_util.h"
+#include "base/logging.h"
 #include "syzygy/msf/msf_decl.h"
 #include "syzygy/msf/msf_file.h"
 #include "syzygy/msf/msf_stream.h"
@@ -42,7 +46,54 @@ class MsfWriterImpl {
   // @returns true on success, false otherwise.
   bool Write(const base::FilePath& msf_path, const MsfFileImpl<T>& msf_file);
 
+  // Writes the given MsfFileImpl to disk by updating an existing MSF file
+  // rather than writing every stream. Streams that are unmodified views of
+  // pages of @p base_msf_path, as read by MsfReaderImpl, stay on those pages.
+  // The other streams and a new directory are written to pages that are
+  // unused in the base file, or appended to it. The new free page map goes in
+  // the free page map slot the base file doesn't use, and the header is
+  // written last, so the previous contents stay valid until the header is
+  // replaced.
+  //
+  // If the paths differ the base file is first copied to @p msf_path, and the
+  // copy is updated. If the base file doesn't use our page size, this falls
+  // back to Write.
+  //
+  // @param base_msf_path the MSF file most streams of @p msf_file come from.
+  //     May be @p msf_path, to update it in place.
+  // @param msf_path the path of the MSF file to write.
+  // @param msf_file the MSF file to be written.
+  // @returns true on success, false otherwise.
+  bool WriteIncremental(const base::FilePath& base_msf_path,
+                        const base::FilePath& msf_path,
+                        const MsfFileImpl<T>& msf_file);
+
+  // @name Accessors and mutators.
+  // @{
+  // The number of threads used to write the streams. Defaults to 1, which
+  // writes the streams one after the other on the calling thread. With more
+  // threads the pages of every stream are allocated up front, and the streams
+  // are then written concurrently to their own pages. Either way the output
+  // is identical. Streams are read from the worker threads, so distinct
+  // streams must support concurrent reads; the file, mapped, byte and
+  // producer streams all do.
+  size_t num_threads() const { return num_threads_; }
+  void set_num_threads(size_t num_threads) {
+    DCHECK_LT(0u, num_threads);
+    num_threads_ = num_threads;
+  }
+  // @}
+
  protected:
+  class StreamWriteWork;
+
+  // Writes the given MsfFileImpl to disk on num_threads_ threads.
+  // @param msf_path the path of the MSF file to write.
+  // @param msf_file the MSF file to be written.
+  // @returns true on success, false otherwise.
+  bool WriteConcurrently(const base::FilePath& msf_path,
+                         const MsfFileImpl<T>& msf_file);
+
   // Append the contents of the stream onto the file handle at the offset. The
   // contents of the file are padded to reach the next page boundary in the
   // output stream. The indices of the written pages are appended to
@@ -53,13 +104,22 @@ class MsfWriterImpl {
                     uint32_t* page_count);
 
   // Writes the MSF header after the directory has been written.
+  // @param free_page_map the page of the active free page map, 1 or 2.
   bool WriteHeader(const std::vector<uint32_t>& root_directory_pages,
                    uint32_t directory_size,
-                   uint32_t page_count);
+                   uint32_t page_count,
+                   uint32_t free_page_map = 1);
+
+  // Writes the streams of @p work on num_threads_ threads.
+  // @returns true on success, false otherwise.
+  bool RunStreamWriteWork(StreamWriteWork* work);
 
   // The current file handle open for writing.
   base::ScopedFILE file_;
 
+  // The number of threads writing streams.
+  size_t num_threads_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(MsfWriterImpl);
 };
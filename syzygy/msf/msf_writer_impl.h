@@ -15,13 +15,20 @@
 #ifndef SYZYGY_MSF_MSF_WRITER_IMPL_H_
 #define SYZYGY_MSF_MSF_WRITER_IMPL_H_
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <utility>
 #include <vector>
 
+#include "base/atomicops.h"
+#include "base/files/file_util.h"
 #include "base/logging.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/msf/msf_constants.h"
 #include "syzygy/msf/msf_data.h"
+#include "syzygy/msf/msf_file_stream.h"
+#include "syzygy/msf/msf_reader.h"
 
 namespace msf {
 namespace detail {
@@ -158,12 +165,210 @@ bool AppendPage(const void* data,
   return true;
 }
 
-bool WriteFreePageBitMap(const FreePageBitMap& free, FILE* file) {
+// Allocates the pages that AppendPage would write @p length bytes of stream
+// data to, without writing anything. The allocated page IDs are appended to
+// @p pages, and @p page_count is advanced past them and past any free page map
+// pages reserved along the way.
+void AllocatePages(uint32_t length,
+                   std::vector<uint32_t>* pages,
+                   uint32_t* page_count) {
+  DCHECK(pages != NULL);
+  DCHECK(page_count != NULL);
+
+  uint32_t num_pages = (length + kMsfPageSize - 1) / kMsfPageSize;
+  for (uint32_t i = 0; i < num_pages; ++i) {
+    // Skip over the pages AppendPage reserves for the free page map.
+    if ((*page_count % kMsfPageSize) == 1)
+      *page_count += 2;
+    pages->push_back(*page_count);
+    ++(*page_count);
+  }
+}
+
+// Initializes @p directory with the stream count and the stream lengths of
+// @p msf_file.
+template <MsfFileType T>
+void InitDirectory(const MsfFileImpl<T>& msf_file,
+                   std::vector<uint32_t>* directory) {
+  DCHECK(directory != NULL);
+
+  directory->clear();
+  directory->push_back(static_cast<uint32_t>(msf_file.StreamCount()));
+  for (uint32_t i = 0; i < msf_file.StreamCount(); ++i) {
+    // Null streams have an implicit zero length.
+    MsfStreamImpl<T>* stream = msf_file.GetStream(i).get();
+    if (stream == NULL)
+      directory->push_back(0);
+    else
+      directory->push_back(static_cast<uint32_t>(stream->length()));
+  }
+}
+
+// Initializes the free page bit map of an MSF file of @p page_count pages. The
+// pages of stream 0, at @p stream0_start to @p stream0_end in @p directory,
+// are always marked as free, as well as page 3 which is allocated in the
+// preamble.
+void InitFreePageBitMap(uint32_t page_count,
+                        const std::vector<uint32_t>& directory,
+                        size_t stream0_start,
+                        size_t stream0_end,
+                        FreePageBitMap* free_page) {
+  DCHECK(free_page != NULL);
+  DCHECK_LE(stream0_start, stream0_end);
+
+  free_page->SetPageCount(page_count);
+  free_page->SetFree(3);
+  for (size_t i = stream0_start; i < stream0_end; ++i)
+    free_page->SetFree(directory[i]);
+  free_page->Finalize();
+}
+
+// @returns true if @p page_index is reserved for one of the two free page
+// maps, which are interleaved with the other pages of the file.
+bool IsFreePageMapPage(uint32_t page_index) {
+  uint32_t index_in_block = page_index % kMsfPageSize;
+  return index_in_block == 1 || index_in_block == 2;
+}
+
+// Allocates pages for an MSF file that is being updated. Pages that are
+// unused in the original file are handed out first, then pages are appended
+// to the file.
+class PageAllocator {
+ public:
+  // @param used the pages of the original file that are in use.
+  explicit PageAllocator(const std::vector<bool>& used)
+      : used_(used),
+        page_count_(static_cast<uint32_t>(used.size())),
+        next_page_(0) {}
+
+  // Allocates pages for @p length bytes of stream data, appending their IDs
+  // to @p pages.
+  void Allocate(uint32_t length, std::vector<uint32_t>* pages) {
+    DCHECK(pages != NULL);
+
+    uint32_t num_pages = (length + kMsfPageSize - 1) / kMsfPageSize;
+    for (uint32_t i = 0; i < num_pages; ++i) {
+      while (next_page_ < used_.size() &&
+             (used_[next_page_] || IsFreePageMapPage(next_page_))) {
+        ++next_page_;
+      }
+      if (next_page_ < used_.size()) {
+        used_[next_page_] = true;
+        pages->push_back(next_page_++);
+        continue;
+      }
+
+      while (IsFreePageMapPage(page_count_))
+        ++page_count_;
+      pages->push_back(page_count_++);
+    }
+  }
+
+  // @returns the number of pages in the file.
+  uint32_t page_count() const { return page_count_; }
+
+ private:
+  std::vector<bool> used_;
+  uint32_t page_count_;
+  uint32_t next_page_;
+};
+
+// Reads the header of the MSF file at @p path and determines which of its
+// pages are in use: the header, the free page maps, the directory and the
+// pages of every stream.
+// @param path the MSF file to read.
+// @param header receives the header of the file.
+// @param used receives a flag per page of the file, set if it's in use.
+// @returns true on success, false otherwise.
+template <MsfFileType T>
+bool GetUsedPages(const base::FilePath& path,
+                  MsfHeader* header,
+                  std::vector<bool>* used) {
+  DCHECK(header != NULL);
+  DCHECK(used != NULL);
+
+  MsfReaderImpl<T> reader;
+  MsfFileImpl<T> msf_file;
+  if (!reader.Read(path, &msf_file))
+    return false;
+
+  scoped_refptr<RefCountedFILE> file(
+      new RefCountedFILE(base::OpenFile(path, "rb")));
+  if (!file->file() ||
+      ::fread(header, sizeof(*header), 1, file->file()) != 1) {
+    LOG(ERROR) << "Failed to read the header of '" << path.value() << "'.";
+    return false;
+  }
+
+  used->assign(header->num_pages, false);
+  std::vector<uint32_t> pages;
+  if (header->num_pages > 0)
+    (*used)[0] = true;
+  for (uint32_t i = 0; i < header->num_pages; ++i) {
+    if (IsFreePageMapPage(i))
+      (*used)[i] = true;
+  }
+
+  // The directory, and the pages listing the directory pages.
+  uint32_t num_dir_pages =
+      (header->directory_size + header->page_size - 1) / header->page_size;
+  uint32_t num_root_pages =
+      (num_dir_pages * sizeof(uint32_t) + header->page_size - 1) /
+      header->page_size;
+  if (num_root_pages > arraysize(header->root_pages)) {
+    LOG(ERROR) << "Invalid MSF directory size.";
+    return false;
+  }
+  pages.assign(header->root_pages, header->root_pages + num_root_pages);
+  std::vector<uint32_t> dir_pages(num_dir_pages);
+  uint32_t dir_pages_size =
+      num_dir_pages * static_cast<uint32_t>(sizeof(dir_pages[0]));
+  scoped_refptr<MsfFileStreamImpl<T>> dir_page_stream(
+      new MsfFileStreamImpl<T>(file.get(), dir_pages_size, header->root_pages,
+                               header->page_size));
+  if (num_dir_pages > 0 &&
+      !dir_page_stream->ReadBytesAt(0, dir_pages_size, dir_pages.data())) {
+    LOG(ERROR) << "Failed to read directory page stream.";
+    return false;
+  }
+  pages.insert(pages.end(), dir_pages.begin(), dir_pages.end());
+
+  // The pages of the streams.
+  for (size_t i = 0; i < msf_file.StreamCount(); ++i) {
+    MsfStreamImpl<T>* stream = msf_file.GetStream(i).get();
+    base::FilePath stream_path;
+    uint32_t page_size = 0;
+    std::vector<uint32_t> stream_pages;
+    if (stream == NULL ||
+        !stream->GetFilePages(&stream_path, &page_size, &stream_pages)) {
+      continue;
+    }
+    pages.insert(pages.end(), stream_pages.begin(), stream_pages.end());
+  }
+
+  for (uint32_t page : pages) {
+    if (page >= header->num_pages) {
+      LOG(ERROR) << "Page " << page << " lies outside of '" << path.value()
+                 << "'.";
+      return false;
+    }
+    (*used)[page] = true;
+  }
+
+  return true;
+}
+
+// Writes the free page bit map to the free page map starting at page
+// @p first_page, which is 1 or 2.
+bool WriteFreePageBitMap(const FreePageBitMap& free,
+                         FILE* file,
+                         size_t first_page = 1) {
   DCHECK(file != NULL);
+  DCHECK(first_page == 1 || first_page == 2);
 
   const uint8_t* data = free.data().data();
   size_t bytes_left = free.data().size();
-  size_t page_index = 1;
+  size_t page_index = first_page;
   size_t bytes_to_write = kMsfPageSize;
   while (true) {
     if (::fseek(file,
@@ -207,8 +412,118 @@ bool WriteFreePageBitMap(const FreePageBitMap& free, FILE* file) {
 
 }  // namespace
 
+// Writes the streams of an MSF file to their preallocated pages. Each work
+// item writes one stream, so the streams are written concurrently when this
+// is run on a thread pool.
 template <MsfFileType T>
-MsfWriterImpl<T>::MsfWriterImpl() {
+class MsfWriterImpl<T>::StreamWriteWork
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param file the file to write to. It must be large enough to hold all of
+  //     the pages written.
+  explicit StreamWriteWork(base::File* file)
+      : file_(file), next_index_(0), failed_(0) {
+    DCHECK(file != NULL);
+  }
+
+  // Adds a stream to be written.
+  // @param stream the stream to write.
+  // @param pages the pages to write @p stream to, starting at @p first_page.
+  //     This must outlive the work.
+  // @param first_page the index of the first page of @p stream in @p pages.
+  void AddStream(MsfStreamImpl<T>* stream,
+                 const std::vector<uint32_t>* pages,
+                 size_t first_page) {
+    DCHECK(stream != NULL);
+    DCHECK(pages != NULL);
+    StreamInfo info = {stream, pages, first_page};
+    streams_.push_back(info);
+  }
+
+  // @returns the number of work items needed to write all of the streams.
+  size_t work_items() const { return streams_.size(); }
+
+  // @returns true if any of the streams failed to be written.
+  bool failed() const { return base::subtle::Acquire_Load(&failed_) != 0; }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, work_items());
+    if (failed())
+      return;
+    if (!WriteStream(streams_[index]))
+      base::subtle::Release_Store(&failed_, 1);
+  }
+  // @}
+
+ private:
+  // The most pages written with a single call.
+  static const size_t kMaxPagesPerWrite = 64;
+
+  struct StreamInfo {
+    MsfStreamImpl<T>* stream;
+    const std::vector<uint32_t>* pages;
+    size_t first_page;
+  };
+
+  // Writes a stream, coalescing runs of consecutive pages into single writes.
+  bool WriteStream(const StreamInfo& info) {
+    const std::vector<uint32_t>& pages = *info.pages;
+    size_t num_pages = (info.stream->length() + kMsfPageSize - 1) /
+        kMsfPageSize;
+    DCHECK_LE(info.first_page + num_pages, pages.size());
+
+    std::vector<uint8_t> buffer;
+    size_t page = 0;
+    while (page < num_pages) {
+      size_t run = 1;
+      while (page + run < num_pages && run < kMaxPagesPerWrite &&
+             pages[info.first_page + page + run] ==
+                 pages[info.first_page + page] + run) {
+        ++run;
+      }
+
+      // Pad the last page of the stream with zeros.
+      size_t pos = page * kMsfPageSize;
+      size_t bytes_to_read = std::min(run * kMsfPageSize,
+                                      info.stream->length() - pos);
+      buffer.assign(run * kMsfPageSize, 0);
+      if (!info.stream->ReadBytesAt(pos, bytes_to_read, buffer.data())) {
+        LOG(ERROR) << "Failed to read " << bytes_to_read << " bytes at offset "
+                   << pos << " of MSF stream.";
+        return false;
+      }
+
+      int64_t offset =
+          static_cast<int64_t>(pages[info.first_page + page]) * kMsfPageSize;
+      int size = static_cast<int>(buffer.size());
+      if (file_->Write(offset, reinterpret_cast<const char*>(buffer.data()),
+                       size) != size) {
+        LOG(ERROR) << "Failed to write page " << pages[info.first_page + page]
+                   << ".";
+        return false;
+      }
+
+      page += run;
+    }
+
+    return true;
+  }
+
+  base::File* file_;
+  std::vector<StreamInfo> streams_;
+
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(StreamWriteWork);
+};
+
+template <MsfFileType T>
+MsfWriterImpl<T>::MsfWriterImpl() : num_threads_(1) {
 }
 
 template <MsfFileType T>
@@ -218,6 +533,9 @@ MsfWriterImpl<T>::~MsfWriterImpl() {
 template <MsfFileType T>
 bool MsfWriterImpl<T>::Write(const base::FilePath& msf_path,
                              const MsfFileImpl<T>& msf_file) {
+  if (num_threads_ > 1)
+    return WriteConcurrently(msf_path, msf_file);
+
   file_.reset(base::OpenFile(msf_path, "wb"));
   if (!file_.get()) {
     LOG(ERROR) << "Failed to create '" << msf_path.value() << "'.";
@@ -226,15 +544,7 @@ bool MsfWriterImpl<T>::Write(const base::FilePath& msf_path,
 
   // Initialize the directory with stream count and lengths.
   std::vector<uint32_t> directory;
-  directory.push_back(static_cast<uint32_t>(msf_file.StreamCount()));
-  for (uint32_t i = 0; i < msf_file.StreamCount(); ++i) {
-    // Null streams have an implicit zero length.
-    MsfStreamImpl<T>* stream = msf_file.GetStream(i).get();
-    if (stream == NULL)
-      directory.push_back(0);
-    else
-      directory.push_back(static_cast<uint32_t>(stream->length()));
-  }
+  InitDirectory(msf_file, &directory);
 
   // Reserve space for the header page, the two free page map pages, and a
   // fourth empty page. The fourth empty page doesn't appear to be strictly
@@ -303,15 +613,10 @@ bool MsfWriterImpl<T>::Write(const base::FilePath& msf_path,
     return false;
   }
 
-  // Initialize the free page bit map. The pages corresponding to stream 0 are
-  // always marked as free, as well as page 3 which we allocated in the
-  // preamble.
+  // Initialize the free page bit map.
   FreePageBitMap free_page;
-  free_page.SetPageCount(page_count);
-  free_page.SetFree(3);
-  for (size_t i = stream0_start; i < stream0_end; ++i)
-    free_page.SetFree(directory[i]);
-  free_page.Finalize();
+  InitFreePageBitMap(page_count, directory, stream0_start, stream0_end,
+                     &free_page);
 
   if (!WriteFreePageBitMap(free_page, file_.get())) {
     LOG(ERROR) << "Failed to write free page bitmap.";
@@ -324,6 +629,293 @@ bool MsfWriterImpl<T>::Write(const base::FilePath& msf_path,
   return true;
 }
 
+template <MsfFileType T>
+bool MsfWriterImpl<T>::WriteConcurrently(const base::FilePath& msf_path,
+                                         const MsfFileImpl<T>& msf_file) {
+  DCHECK_LT(1u, num_threads_);
+
+  // Lay out every page exactly where Write would put it, starting after the
+  // four preamble pages, and build the directory while we're at it. The
+  // directory has to be complete before any page references into it are
+  // taken, so the streams to write are first recorded by page index.
+  std::vector<uint32_t> directory;
+  InitDirectory(msf_file, &directory);
+  uint32_t page_count = 4;
+  std::vector<std::pair<MsfStreamImpl<T>*, size_t>> streams;
+  size_t stream0_start = directory.size();
+  size_t stream0_end = 0;
+  for (uint32_t i = 0; i < msf_file.StreamCount(); ++i) {
+    if (i == 1)
+      stream0_end = directory.size();
+
+    // Null streams are treated as empty streams.
+    MsfStreamImpl<T>* stream = msf_file.GetStream(i).get();
+    if (stream == NULL || stream->length() == 0)
+      continue;
+
+    streams.push_back(std::make_pair(stream, directory.size()));
+    AllocatePages(stream->length(), &directory, &page_count);
+  }
+  DCHECK_LE(stream0_start, stream0_end);
+
+  uint32_t directory_size =
+      static_cast<uint32_t>(sizeof(directory[0]) * directory.size());
+  std::vector<uint32_t> directory_pages;
+  AllocatePages(directory_size, &directory_pages, &page_count);
+  std::vector<uint32_t> root_directory_pages;
+  AllocatePages(static_cast<uint32_t>(sizeof(directory_pages[0]) *
+                                      directory_pages.size()),
+                &root_directory_pages, &page_count);
+
+  scoped_refptr<MsfStreamImpl<T>> directory_stream(
+      new ReadOnlyMsfStream<T>(directory.data(), directory_size));
+  scoped_refptr<MsfStreamImpl<T>> root_directory_stream(
+      new ReadOnlyMsfStream<T>(
+          directory_pages.data(),
+          sizeof(directory_pages[0]) *
+              static_cast<uint32_t>(directory_pages.size())));
+
+  {
+    // The file is sized up front, so that the pages that are never written,
+    // such as the preamble and the free page map, read as zeros.
+    base::File file(msf_path,
+                    base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+    if (!file.IsValid() ||
+        !file.SetLength(static_cast<int64_t>(page_count) * kMsfPageSize)) {
+      LOG(ERROR) << "Failed to create '" << msf_path.value() << "'.";
+      return false;
+    }
+
+    StreamWriteWork work(&file);
+    for (size_t i = 0; i < streams.size(); ++i)
+      work.AddStream(streams[i].first, &directory, streams[i].second);
+    work.AddStream(directory_stream.get(), &directory_pages, 0);
+    work.AddStream(root_directory_stream.get(), &root_directory_pages, 0);
+
+    if (!RunStreamWriteWork(&work))
+      return false;
+  }
+
+  // The header and the free page map are written last, through the same
+  // routines as Write.
+  file_.reset(base::OpenFile(msf_path, "r+b"));
+  if (!file_.get()) {
+    LOG(ERROR) << "Failed to reopen '" << msf_path.value() << "'.";
+    return false;
+  }
+
+  if (!WriteHeader(root_directory_pages, directory_size, page_count)) {
+    LOG(ERROR) << "Failed to write MSF header.";
+    return false;
+  }
+
+  FreePageBitMap free_page;
+  InitFreePageBitMap(page_count, directory, stream0_start, stream0_end,
+                     &free_page);
+  if (!WriteFreePageBitMap(free_page, file_.get())) {
+    LOG(ERROR) << "Failed to write free page bitmap.";
+    return false;
+  }
+
+  file_.reset();
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfWriterImpl<T>::WriteIncremental(const base::FilePath& base_msf_path,
+                                        const base::FilePath& msf_path,
+                                        const MsfFileImpl<T>& msf_file) {
+  MsfHeader base_header = {0};
+  std::vector<bool> used;
+  if (!GetUsedPages<T>(base_msf_path, &base_header, &used)) {
+    LOG(ERROR) << "Failed to read '" << base_msf_path.value() << "'.";
+    return false;
+  }
+
+  bool in_place = base_msf_path == msf_path;
+  if (base_header.page_size != kMsfPageSize) {
+    if (in_place) {
+      LOG(ERROR) << "Can't update an MSF file with a page size of "
+                 << base_header.page_size << " in place.";
+      return false;
+    }
+    VLOG(1) << "The base MSF file has a page size of "
+            << base_header.page_size << ", writing it in full.";
+    return Write(msf_path, msf_file);
+  }
+
+  // Build the directory, keeping the pages of the streams that come straight
+  // from the base file and allocating pages for the others. Stream 0 is
+  // tracked as in Write, for the free page map.
+  std::vector<uint32_t> directory;
+  InitDirectory(msf_file, &directory);
+  PageAllocator allocator(used);
+  std::vector<std::pair<MsfStreamImpl<T>*, size_t>> streams;
+  std::vector<bool> kept_pages(used.size(), false);
+  size_t stream0_start = directory.size();
+  size_t stream0_end = 0;
+  size_t kept_streams = 0;
+  for (uint32_t i = 0; i < msf_file.StreamCount(); ++i) {
+    if (i == 1)
+      stream0_end = directory.size();
+
+    MsfStreamImpl<T>* stream = msf_file.GetStream(i).get();
+    if (stream == NULL || stream->length() == 0)
+      continue;
+
+    base::FilePath stream_path;
+    uint32_t page_size = 0;
+    std::vector<uint32_t> pages;
+    if (stream->GetFilePages(&stream_path, &page_size, &pages) &&
+        stream_path == base_msf_path && page_size == kMsfPageSize) {
+      DCHECK_EQ((stream->length() + kMsfPageSize - 1) / kMsfPageSize,
+                pages.size());
+      for (uint32_t page : pages) {
+        DCHECK_LT(page, kept_pages.size());
+        kept_pages[page] = true;
+      }
+      directory.insert(directory.end(), pages.begin(), pages.end());
+      ++kept_streams;
+      continue;
+    }
+
+    streams.push_back(std::make_pair(stream, directory.size()));
+    allocator.Allocate(stream->length(), &directory);
+  }
+  DCHECK_LE(stream0_start, stream0_end);
+  VLOG(1) << "Keeping " << kept_streams << " streams of '"
+          << base_msf_path.value() << "', writing " << streams.size() << ".";
+
+  uint32_t directory_size =
+      static_cast<uint32_t>(sizeof(directory[0]) * directory.size());
+  std::vector<uint32_t> directory_pages;
+  allocator.Allocate(directory_size, &directory_pages);
+  std::vector<uint32_t> root_directory_pages;
+  allocator.Allocate(static_cast<uint32_t>(sizeof(directory_pages[0]) *
+                                          directory_pages.size()),
+                     &root_directory_pages);
+  uint32_t page_count = allocator.page_count();
+
+  scoped_refptr<MsfStreamImpl<T>> directory_stream(
+      new ReadOnlyMsfStream<T>(directory.data(), directory_size));
+  scoped_refptr<MsfStreamImpl<T>> root_directory_stream(
+      new ReadOnlyMsfStream<T>(
+          directory_pages.data(),
+          sizeof(directory_pages[0]) *
+              static_cast<uint32_t>(directory_pages.size())));
+
+  // The copy may be made by cloning the blocks of the base file, where the
+  // file system supports it. It can't be a hard link, as it's modified.
+  if (!in_place && !base::CopyFile(base_msf_path, msf_path)) {
+    LOG(ERROR) << "Failed to copy '" << base_msf_path.value() << "' to '"
+               << msf_path.value() << "'.";
+    return false;
+  }
+
+  {
+    base::File file(msf_path, base::File::FLAG_OPEN | base::File::FLAG_READ |
+                                  base::File::FLAG_WRITE);
+    if (!file.IsValid()) {
+      LOG(ERROR) << "Failed to open '" << msf_path.value() << "'.";
+      return false;
+    }
+    if (page_count > base_header.num_pages &&
+        !file.SetLength(static_cast<int64_t>(page_count) * kMsfPageSize)) {
+      LOG(ERROR) << "Failed to grow '" << msf_path.value() << "'.";
+      return false;
+    }
+
+    StreamWriteWork work(&file);
+    for (size_t i = 0; i < streams.size(); ++i)
+      work.AddStream(streams[i].first, &directory, streams[i].second);
+    work.AddStream(directory_stream.get(), &directory_pages, 0);
+    work.AddStream(root_directory_stream.get(), &root_directory_pages, 0);
+    if (!RunStreamWriteWork(&work))
+      return false;
+
+    // Everything the new header refers to must be on disk before the header
+    // itself.
+    if (!file.Flush()) {
+      LOG(ERROR) << "Failed to flush '" << msf_path.value() << "'.";
+      return false;
+    }
+  }
+
+  // Only the pages the new version uses are marked as used: the free page
+  // maps, the kept and written stream pages and the directory. Stream 0 and
+  // page 3 are free, as in Write.
+  DCHECK(base_header.free_page_map == 1 || base_header.free_page_map == 2);
+  uint32_t free_page_map = base_header.free_page_map == 1 ? 2 : 1;
+  std::vector<bool> new_used(page_count, false);
+  new_used[0] = true;
+  for (uint32_t i = 0; i < page_count; ++i) {
+    if (IsFreePageMapPage(i) || (i < kept_pages.size() && kept_pages[i]))
+      new_used[i] = true;
+  }
+  for (size_t i = 0; i < streams.size(); ++i) {
+    size_t num_pages =
+        (streams[i].first->length() + kMsfPageSize - 1) / kMsfPageSize;
+    for (size_t j = 0; j < num_pages; ++j)
+      new_used[directory[streams[i].second + j]] = true;
+  }
+  for (uint32_t page : directory_pages)
+    new_used[page] = true;
+  for (uint32_t page : root_directory_pages)
+    new_used[page] = true;
+  for (size_t i = stream0_start; i < stream0_end; ++i)
+    new_used[directory[i]] = false;
+
+  FreePageBitMap free_page;
+  free_page.SetPageCount(page_count);
+  for (uint32_t i = 0; i < page_count; ++i) {
+    if (!new_used[i])
+      free_page.SetFree(i);
+  }
+  free_page.Finalize();
+
+  file_.reset(base::OpenFile(msf_path, "r+b"));
+  if (!file_.get()) {
+    LOG(ERROR) << "Failed to reopen '" << msf_path.value() << "'.";
+    return false;
+  }
+
+  if (!WriteFreePageBitMap(free_page, file_.get(), free_page_map) ||
+      ::fflush(file_.get()) != 0) {
+    LOG(ERROR) << "Failed to write free page bitmap.";
+    return false;
+  }
+
+  if (!WriteHeader(root_directory_pages, directory_size, page_count,
+                   free_page_map)) {
+    LOG(ERROR) << "Failed to write MSF header.";
+    return false;
+  }
+
+  file_.reset();
+
+  return true;
+}
+
+template <MsfFileType T>
+bool MsfWriterImpl<T>::RunStreamWriteWork(StreamWriteWork* work) {
+  DCHECK(work != NULL);
+
+  size_t work_items = work->work_items();
+  if (num_threads_ <= 1 || work_items <= 1) {
+    for (size_t i = 0; i < work_items && !work->failed(); ++i)
+      work->Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "MsfWriter", static_cast<int>(std::min(num_threads_, work_items)));
+    pool.Start();
+    pool.AddWork(work, static_cast<int>(work_items));
+    pool.JoinAll();
+  }
+
+  return !work->failed();
+}
+
 template <MsfFileType T>
 bool MsfWriterImpl<T>::AppendStream(MsfStreamImpl<T>* stream,
                                     std::vector<uint32_t>* pages_written,
@@ -381,7 +973,8 @@ template <MsfFileType T>
 bool MsfWriterImpl<T>::WriteHeader(
     const std::vector<uint32_t>& root_directory_pages,
     uint32_t directory_size,
-    uint32_t page_count) {
+    uint32_t page_count,
+    uint32_t free_page_map) {
   VLOG(1) << "Writing MSF Header ...";
 
   MsfHeader header = {0};
@@ -403,7 +996,7 @@ bool MsfWriterImpl<T>::WriteHeader(
   ::memcpy(header.magic_string, kMsfHeaderMagicString,
            sizeof(kMsfHeaderMagicString));
   header.page_size = kMsfPageSize;
-  header.free_page_map = 1;
+  header.free_page_map = free_page_map;
   header.num_pages = page_count;
   header.directory_size = directory_size;
   header.reserved = 0;
@@ -15,13 +15,16 @@
 #include "syzygy/msf/msf_writer.h"
 
 #include <algorithm>
+#include <string>
 #include <vector>
 
+#include "base/bind.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
 #include "syzygy/msf/msf_constants.h"
 #include "syzygy/msf/msf_data.h"
+#include "syzygy/msf/msf_producer_stream.h"
 #include "syzygy/msf/msf_reader.h"
 #include "syzygy/msf/unittest_util.h"
 
@@ -84,6 +87,23 @@ class TestMsfStream : public MsfStream {
   std::vector<uint8_t> data_;
 };
 
+// Produces a stream of bytes encoding their own position.
+bool ProduceBytes(size_t pos, size_t count, void* dest) {
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(dest);
+  for (size_t i = 0; i < count; ++i)
+    bytes[i] = static_cast<uint8_t>((pos + i) * 7);
+  return true;
+}
+
+bool ReadFileContents(const base::FilePath& path,
+                      std::vector<uint8_t>* contents) {
+  std::string data;
+  if (!base::ReadFileToString(path, &data))
+    return false;
+  contents->assign(data.begin(), data.end());
+  return true;
+}
+
 void EnsureMsfContentsAreIdentical(const MsfFile& msf_file,
                                    const MsfFile& msf_file_read) {
   ASSERT_EQ(msf_file.StreamCount(), msf_file_read.StreamCount());
@@ -216,4 +236,101 @@ TEST(MsfWriterTest, WriteMsfFile) {
       testing::EnsureMsfContentsAreIdentical(msf_file, msf_file_read));
 }
 
+TEST(MsfWriterTest, WriteMsfFileConcurrently) {
+  // Make enough data for the free page map to be interleaved with the
+  // streams, and include empty and produced streams.
+  MsfFile msf_file;
+  msf_file.AppendStream(new TestMsfStream(3 * kMsfPageSize + 17, 0));
+  msf_file.AppendStream(new TestMsfStream(0, 0));
+  for (uint32_t i = 0; i < 6; ++i) {
+    msf_file.AppendStream(
+        new TestMsfStream((1 << (10 + i)) * kMsfPageSize / 64, (i << 24)));
+  }
+  msf_file.AppendStream(new MsfProducerStream(
+      kMsfPageSize * kMsfPageSize + 5, base::Bind(&ProduceBytes)));
+
+  testing::ScopedTempFile sequential_file;
+  testing::ScopedTempFile concurrent_file;
+  {
+    MsfWriter writer;
+    EXPECT_TRUE(writer.Write(sequential_file.path(), msf_file));
+    writer.set_num_threads(4);
+    EXPECT_TRUE(writer.Write(concurrent_file.path(), msf_file));
+  }
+
+  // The output doesn't depend on the number of threads.
+  std::vector<uint8_t> sequential_contents;
+  std::vector<uint8_t> concurrent_contents;
+  ASSERT_TRUE(ReadFileContents(sequential_file.path(), &sequential_contents));
+  ASSERT_TRUE(ReadFileContents(concurrent_file.path(), &concurrent_contents));
+  ASSERT_LT(kMsfPageSize * kMsfPageSize, concurrent_contents.size());
+  EXPECT_TRUE(sequential_contents == concurrent_contents);
+
+  MsfFile msf_file_read;
+  MsfReader reader;
+  EXPECT_TRUE(reader.Read(concurrent_file.path(), &msf_file_read));
+  ASSERT_EQ(msf_file.StreamCount(), msf_file_read.StreamCount());
+  for (size_t i = 0; i < msf_file.StreamCount(); ++i) {
+    scoped_refptr<MsfStream> stream = msf_file.GetStream(i);
+    scoped_refptr<MsfStream> stream_read = msf_file_read.GetStream(i);
+    ASSERT_EQ(stream->length(), stream_read->length());
+    if (stream->length() == 0)
+      continue;
+    std::vector<uint8_t> data(stream->length());
+    std::vector<uint8_t> data_read(stream->length());
+    ASSERT_TRUE(stream->ReadBytesAt(0, data.size(), data.data()));
+    ASSERT_TRUE(stream_read->ReadBytesAt(0, data.size(), data_read.data()));
+    EXPECT_TRUE(data == data_read);
+  }
+}
+
+TEST(MsfWriterTest, WriteMsfFileIncrementally) {
+  MsfFile msf_file;
+  for (uint32_t i = 0; i < 6; ++i)
+    msf_file.AppendStream(new TestMsfStream(1 << (10 + i), (i << 24)));
+
+  testing::ScopedTempFile base_file;
+  testing::ScopedTempFile file;
+  {
+    MsfWriter writer;
+    EXPECT_TRUE(writer.Write(base_file.path(), msf_file));
+  }
+
+  // Replace one of the streams and add a new one.
+  MsfFile msf_file_read;
+  MsfReader reader;
+  ASSERT_TRUE(reader.Read(base_file.path(), &msf_file_read));
+  msf_file_read.ReplaceStream(2, new TestMsfStream(3 * kMsfPageSize, 0));
+  msf_file_read.AppendStream(new TestMsfStream(kMsfPageSize + 9, 0xFF));
+
+  // Update a copy of the base file, then the base file itself.
+  for (const base::FilePath& path : {file.path(), base_file.path()}) {
+    MsfWriter writer;
+    EXPECT_TRUE(
+        writer.WriteIncremental(base_file.path(), path, msf_file_read));
+
+    MsfFile msf_file_updated;
+    MsfReader updated_reader;
+    ASSERT_TRUE(updated_reader.Read(path, &msf_file_updated));
+    ASSERT_NO_FATAL_FAILURE(testing::EnsureMsfContentsAreIdentical(
+        msf_file_read, msf_file_updated));
+
+    // The unmodified streams stay on the pages they had in the base file.
+    for (size_t i = 0; i < msf_file_read.StreamCount(); ++i) {
+      base::FilePath stream_path;
+      uint32_t page_size = 0;
+      std::vector<uint32_t> pages;
+      if (!msf_file_read.GetStream(i)->GetFilePages(&stream_path, &page_size,
+                                                    &pages)) {
+        continue;
+      }
+      base::FilePath updated_path;
+      std::vector<uint32_t> updated_pages;
+      ASSERT_TRUE(msf_file_updated.GetStream(i)->GetFilePages(
+          &updated_path, &page_size, &updated_pages));
+      EXPECT_EQ(pages, updated_pages);
+    }
+  }
+}
+
 }  // namespace msf
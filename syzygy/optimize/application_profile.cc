@@ -14,9 +14,17 @@
 
 #include "syzygy/optimize/application_profile.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <map>
 #include <queue>
 
+#include "base/files/file_util.h"
+#include "base/sys_info.h"
+#include "syzygy/block_graph/block_hash.h"
+#include "syzygy/block_graph/block_hash_index.h"
+#include "syzygy/core/serialization.h"
 #include "syzygy/grinder/basic_block_util.h"
 
 namespace optimize {
@@ -24,6 +32,8 @@ namespace optimize {
 namespace {
 
 using block_graph::BlockGraph;
+using block_graph::BlockHash;
+using block_graph::BlockHashIndex;
 using block_graph::BasicBlockSubGraph;
 using grinder::basic_block_util::IndexedFrequencyMap;
 using grinder::basic_block_util::IndexedFrequencyOffset;
@@ -43,6 +53,48 @@ const size_t kEntryCountColumn = 0;
 const size_t kBranchTakenColumn = 1;
 const size_t kMissPredColumn = 2;
 
+// The version of the profile file format. Bump this whenever the format or the
+// computation of BlockHash change.
+const uint32_t kProfileVersion = 1;
+
+// A count of a saved profile, relative to the start of its block.
+struct SavedCount {
+  template<class OutArchive> bool Save(OutArchive* out_archive) const {
+    return out_archive->Save(offset) && out_archive->Save(column) &&
+        out_archive->Save(count);
+  }
+  template<class InArchive> bool Load(InArchive* in_archive) {
+    return in_archive->Load(&offset) && in_archive->Load(&column) &&
+        in_archive->Load(&count);
+  }
+
+  Offset offset;
+  uint32_t column;
+  EntryCountType count;
+};
+
+// The counts of a block in a saved profile, keyed by the hash of the block.
+struct SavedBlock {
+  template<class OutArchive> bool Save(OutArchive* out_archive) const {
+    for (size_t i = 0; i < sizeof(hash.md5_digest.a); ++i) {
+      if (!out_archive->Save(hash.md5_digest.a[i]))
+        return false;
+    }
+    return out_archive->Save(counts);
+  }
+  template<class InArchive> bool Load(InArchive* in_archive) {
+    for (size_t i = 0; i < sizeof(hash.md5_digest.a); ++i) {
+      if (!in_archive->Load(&hash.md5_digest.a[i]))
+        return false;
+    }
+    return in_archive->Load(&counts);
+  }
+
+  BlockHash hash;
+  std::vector<SavedCount> counts;
+};
+typedef std::vector<SavedBlock> SavedBlockVector;
+
 // Compare two profiles. Used by STL containers.
 struct BlockProfileCompare {
   bool operator()(const BlockProfile* a, const BlockProfile* b) const {
@@ -93,6 +145,8 @@ bool GetAddressOfBlock(const BlockGraph::Block* block,
 
 }  // namespace
 
+const double ApplicationProfile::kHotPercentile = 0.9;
+
 ApplicationProfile::ApplicationProfile(const ImageLayout* image_layout)
     : image_layout_(image_layout), global_temperature_(0.0) {
   empty_profile_.reset(new BlockProfile());
@@ -107,6 +161,36 @@ const BlockProfile* ApplicationProfile::GetBlockProfile(
   return empty_profile_.get();
 }
 
+void ApplicationProfile::CopyBlockProfile(BlockGraph::BlockId original_id,
+                                          const BlockGraph::Block* block) {
+  DCHECK_NE(reinterpret_cast<const BlockGraph::Block*>(NULL), block);
+  DCHECK_NE(original_id, block->id());
+
+  ProfileMap::const_iterator it = profiles_.find(original_id);
+  if (it == profiles_.end())
+    return;
+
+  profiles_[block->id()] = it->second;
+}
+
+void ApplicationProfile::SplitBlockProfile(BlockGraph::BlockId original_id,
+                                           const BlockGraph::Block* block,
+                                           double temperature) {
+  DCHECK_NE(reinterpret_cast<const BlockGraph::Block*>(NULL), block);
+  DCHECK_NE(original_id, block->id());
+
+  if (temperature == 0)
+    return;
+
+  ProfileMap::const_iterator it = profiles_.find(original_id);
+  if (it == profiles_.end())
+    return;
+
+  BlockProfile part(it->second.count(), temperature);
+  part.set_percentile(std::max(it->second.percentile(), kHotPercentile));
+  profiles_[block->id()] = part;
+}
+
 bool ApplicationProfile::ComputeGlobalProfile() {
   DCHECK_NE(reinterpret_cast<const ImageLayout*>(NULL), image_layout_);
   const BlockGraph* graph = image_layout_->blocks.graph();
@@ -190,11 +274,220 @@ bool ApplicationProfile::ComputeGlobalProfile() {
 
 bool ApplicationProfile::ImportFrequencies(
     const IndexedFrequencyMap& frequencies) {
-  // TODO(etienneb): Support importing multiple sets.
-  frequencies_ = frequencies;
+  return ImportFrequencies(frequencies, 1.0);
+}
+
+bool ApplicationProfile::ImportFrequencies(
+    const IndexedFrequencyMap& frequencies,
+    double weight) {
+  DCHECK_LT(0.0, weight);
+
+  IndexedFrequencyMap::const_iterator it = frequencies.begin();
+  for (; it != frequencies.end(); ++it) {
+    if (it->second < 0) {
+      LOG(ERROR) << "Negative frequency at " << it->first.first << ".";
+      return false;
+    }
+    AddFrequency(it->first, weight * it->second);
+  }
+
   return true;
 }
 
+bool ApplicationProfile::ImportHeat(const HeatMap& heat_map, double weight) {
+  DCHECK_NE(reinterpret_cast<const ImageLayout*>(NULL), image_layout_);
+  DCHECK_LT(0.0, weight);
+
+  HeatMap::const_iterator it = heat_map.begin();
+  for (; it != heat_map.end(); ++it) {
+    double count = weight * it->second.heat;
+    if (count <= 0)
+      continue;
+
+    RelativeAddress addr = it->first.start();
+    AddFrequency(std::make_pair(addr, kEntryCountColumn), count);
+
+    // Samples rarely land at the very start of a block, which is where the
+    // block entry count lives. Make sure a sampled block counts as executed.
+    const BlockGraph::Block* block =
+        image_layout_->blocks.GetBlockByAddress(addr);
+    RelativeAddress block_addr;
+    if (block == NULL ||
+        !image_layout_->blocks.GetAddressOf(block, &block_addr)) {
+      continue;
+    }
+    IndexedFrequencyOffset key = std::make_pair(block_addr, kEntryCountColumn);
+    if (frequencies_.find(key) == frequencies_.end())
+      AddFrequency(key, 1.0);
+  }
+
+  return true;
+}
+
+bool ApplicationProfile::ImportFromFile(const base::FilePath& path,
+                                        double weight) {
+  DCHECK_NE(reinterpret_cast<const ImageLayout*>(NULL), image_layout_);
+  const BlockGraph* graph = image_layout_->blocks.graph();
+  DCHECK_NE(reinterpret_cast<const BlockGraph*>(NULL), graph);
+  DCHECK_LT(0.0, weight);
+
+  base::ScopedFILE file(base::OpenFile(path, "rb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to open profile: " << path.value();
+    return false;
+  }
+
+  core::FileInStream file_stream(file.get());
+  core::BufferedInStream in_stream(&file_stream);
+  core::NativeBinaryInArchive in_archive(&in_stream);
+  uint32_t version = 0;
+  if (!in_archive.Load(&version)) {
+    LOG(ERROR) << "Unable to read profile: " << path.value();
+    return false;
+  }
+  if (version != kProfileVersion) {
+    LOG(ERROR) << "Unsupported version " << version << " of profile: "
+               << path.value();
+    return false;
+  }
+  SavedBlockVector saved_blocks;
+  if (!in_archive.Load(&saved_blocks)) {
+    LOG(ERROR) << "Unable to read profile: " << path.value();
+    return false;
+  }
+
+  // Remap the counts to the blocks having the same content, as long as there
+  // is no ambiguity about which block that is.
+  BlockHashIndex index;
+  index.Build(*graph, base::SysInfo::NumberOfProcessors());
+  size_t remapped_count = 0;
+  size_t dropped_count = 0;
+  BlockHashIndex::BlockIdVector block_ids;
+  for (size_t i = 0; i < saved_blocks.size(); ++i) {
+    const SavedBlock& saved_block = saved_blocks[i];
+    const BlockGraph::Block* block = NULL;
+    RelativeAddress addr;
+    if (index.Find(saved_block.hash, &block_ids) == 1)
+      block = graph->GetBlockById(block_ids[0]);
+    if (block == NULL || !image_layout_->blocks.GetAddressOf(block, &addr)) {
+      dropped_count += saved_block.counts.size();
+      continue;
+    }
+
+    for (size_t j = 0; j < saved_block.counts.size(); ++j) {
+      const SavedCount& saved_count = saved_block.counts[j];
+      if (saved_count.offset < 0 ||
+          static_cast<size_t>(saved_count.offset) >= block->size() ||
+          saved_count.count < 0) {
+        LOG(ERROR) << "Corrupt profile: " << path.value();
+        return false;
+      }
+      AddFrequency(std::make_pair(addr + saved_count.offset,
+                                  saved_count.column),
+                   weight * saved_count.count);
+      ++remapped_count;
+    }
+  }
+
+  LOG(INFO) << "Remapped " << remapped_count << " counts and dropped "
+            << dropped_count << " counts of profile: " << path.value();
+
+  return true;
+}
+
+void ApplicationProfile::Decay(double factor) {
+  DCHECK_LE(0.0, factor);
+  DCHECK_GE(1.0, factor);
+
+  IndexedFrequencyMap::iterator it = frequencies_.begin();
+  while (it != frequencies_.end()) {
+    it->second = static_cast<EntryCountType>(std::floor(
+        factor * it->second + 0.5));
+    if (it->second == 0)
+      it = frequencies_.erase(it);
+    else
+      ++it;
+  }
+}
+
+bool ApplicationProfile::SaveToFile(const base::FilePath& path) const {
+  DCHECK_NE(reinterpret_cast<const ImageLayout*>(NULL), image_layout_);
+
+  const BlockGraph* graph = image_layout_->blocks.graph();
+  DCHECK_NE(reinterpret_cast<const BlockGraph*>(NULL), graph);
+
+  // Group the counts by block. The frequencies are sorted by address, so the
+  // counts of a block are contiguous. The counts of blocks sharing their hash
+  // with other blocks can't be told apart once remapped, so they are dropped.
+  BlockHashIndex index;
+  index.Build(*graph, base::SysInfo::NumberOfProcessors());
+  BlockHashIndex::BlockIdVector block_ids;
+  SavedBlockVector saved_blocks;
+  const BlockGraph::Block* current_block = NULL;
+  RelativeAddress current_addr;
+  bool current_is_unique = false;
+  IndexedFrequencyMap::const_iterator it = frequencies_.begin();
+  for (; it != frequencies_.end(); ++it) {
+    RelativeAddress addr = it->first.first;
+    if (current_block == NULL ||
+        addr >= current_addr + current_block->size()) {
+      current_block = image_layout_->blocks.GetBlockByAddress(addr);
+      if (current_block == NULL ||
+          !image_layout_->blocks.GetAddressOf(current_block, &current_addr)) {
+        current_block = NULL;
+        continue;
+      }
+      BlockHash hash(current_block);
+      current_is_unique = index.Find(hash, &block_ids) == 1;
+      if (current_is_unique) {
+        saved_blocks.push_back(SavedBlock());
+        saved_blocks.back().hash = hash;
+      }
+    }
+    if (!current_is_unique)
+      continue;
+
+    SavedCount saved_count = { addr - current_addr,
+                               static_cast<uint32_t>(it->first.second),
+                               it->second };
+    saved_blocks.back().counts.push_back(saved_count);
+  }
+
+  base::ScopedFILE file(base::OpenFile(path, "wb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to create profile: " << path.value();
+    return false;
+  }
+
+  core::FileOutStream file_stream(file.get());
+  core::BufferedOutStream out_stream(&file_stream);
+  core::NativeBinaryOutArchive out_archive(&out_stream);
+  if (!out_archive.Save(kProfileVersion) ||
+      !out_archive.Save(saved_blocks) ||
+      !out_archive.Flush()) {
+    LOG(ERROR) << "Unable to write profile: " << path.value();
+    return false;
+  }
+
+  return true;
+}
+
+void ApplicationProfile::AddFrequency(const IndexedFrequencyOffset& key,
+                                      double count) {
+  DCHECK_LE(0.0, count);
+
+  const double kMaxCount = std::numeric_limits<EntryCountType>::max();
+  IndexedFrequencyMap::iterator it = frequencies_.find(key);
+  double total = std::floor(count + 0.5);
+  if (it != frequencies_.end())
+    total += it->second;
+  if (total == 0)
+    return;
+  total = std::min(total, kMaxCount);
+
+  frequencies_[key] = static_cast<EntryCountType>(total);
+}
+
 void ApplicationProfile::ComputeSubGraphProfile(
     const BasicBlockSubGraph* subgraph,
     std::unique_ptr<SubGraphProfile>* profile) {
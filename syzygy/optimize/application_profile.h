@@ -18,6 +18,8 @@
 //
 // Example:
 //   ApplicationProfile profile(&image_layout);
+//   profile.ImportFromFile(previous_profile_path, 1.0);
+//   profile.Decay(0.5);
 //   profile.ImportFrequencies(frequencies);
 //   profile.ComputeGlobalProfile();
 //
@@ -28,15 +30,23 @@
 //   }
 //
 // Transformations are responsible for updating metrics when possible.
+//
+// Several sources can be merged into a profile, each with a weight: branch
+// and basic-block entry counts, sampling profiler heat, and profiles saved
+// for previous builds of the application. Saved profiles key their counts by
+// the BlockHash of the blocks, so that they are remapped to the blocks left
+// unchanged by a rebuild.
 
 #ifndef SYZYGY_OPTIMIZE_APPLICATION_PROFILE_H_
 #define SYZYGY_OPTIMIZE_APPLICATION_PROFILE_H_
 
 #include <map>
 
+#include "base/files/file_path.h"
 #include "syzygy/block_graph/basic_block.h"
 #include "syzygy/block_graph/basic_block_subgraph.h"
 #include "syzygy/grinder/basic_block_util.h"
+#include "syzygy/grinder/grinders/sample_grinder.h"
 #include "syzygy/pe/image_layout.h"
 
 namespace optimize {
@@ -50,13 +60,21 @@ class ApplicationProfile {
   typedef block_graph::BasicBlockSubGraph BasicBlockSubGraph;
   typedef block_graph::BlockGraph BlockGraph;
   typedef grinder::basic_block_util::IndexedFrequencyMap IndexedFrequencyMap;
+  typedef grinder::basic_block_util::IndexedFrequencyOffset
+      IndexedFrequencyOffset;
   typedef grinder::basic_block_util::EntryCountType EntryCountType;
+  typedef grinder::grinders::SampleGrinder::HeatMap HeatMap;
   typedef pe::ImageLayout ImageLayout;
 
   // Forward declaration.
   class BlockProfile;
   typedef std::map<BlockGraph::BlockId, BlockProfile> ProfileMap;
 
+  // Executed blocks with a percentile below this are considered hot. Blocks
+  // are ranked hottest first, so the hot blocks together account for this
+  // fraction of the global temperature.
+  static const double kHotPercentile;
+
   // Constructor.
   // @param image_layout The image layout.
   // @note |image_layout| must remains alive until this class get destroyed.
@@ -68,6 +86,27 @@ class ApplicationProfile {
   //     no information available.
   const BlockProfile* GetBlockProfile(const BlockGraph::Block* block) const;
 
+  // Carries the profile of a block over to a block built to replace it, as
+  // is done when a transformed subgraph is merged back into the block graph.
+  // @param original_id the ID of the block that was replaced.
+  // @param block the block replacing it.
+  // @note This does nothing if there is no profile for |original_id|.
+  void CopyBlockProfile(BlockGraph::BlockId original_id,
+                        const BlockGraph::Block* block);
+
+  // Gives a profile to a block holding a part split off another block, as is
+  // done by the function splitting transform. The part keeps the entry count
+  // of the original block, but never ranks hotter than kHotPercentile.
+  // @param original_id the ID of the block the part was split from.
+  // @param block the block holding the part.
+  // @param temperature the sum of the entry counts of the basic blocks of the
+  //     part.
+  // @note This does nothing if there is no profile for |original_id|, or if
+  //     the part never ran.
+  void SplitBlockProfile(BlockGraph::BlockId original_id,
+                         const BlockGraph::Block* block,
+                         double temperature);
+
   // @returns the global temperature of the basic block;
   // @note Invalid until the call to ComputeGlobalProfile.
   double global_temperature() const { return global_temperature_; }
@@ -84,16 +123,55 @@ class ApplicationProfile {
   void ComputeSubGraphProfile(const BasicBlockSubGraph* subgraph,
                               std::unique_ptr<SubGraphProfile>* profile);
 
-  // Import the frequency information of an application.
-  // @param frequencies the branches frequencies.
+  // Import the frequency information of an application. This merges into the
+  // frequencies imported so far.
+  // @param frequencies the branches or basic-block entry frequencies.
   // @returns true on success, false otherwise.
-  // @note This function should only be called once.
-  // TODO(etienneb): Support multiple importation.
+  // @note The import functions must be called before ComputeGlobalProfile.
   bool ImportFrequencies(const IndexedFrequencyMap& frequencies);
 
+  // Import weighted frequency information of an application.
+  // @param frequencies the branches or basic-block entry frequencies.
+  // @param weight the factor applied to the frequencies. Must be positive.
+  // @returns true on success, false otherwise.
+  bool ImportFrequencies(const IndexedFrequencyMap& frequencies,
+                         double weight);
+
+  // Import the heat of a sampling profiler, as basic-block entry counts.
+  // @param heat_map the heat of the basic blocks.
+  // @param weight the number of entries per unit of heat. Must be positive.
+  // @returns true on success, false otherwise.
+  bool ImportHeat(const HeatMap& heat_map, double weight);
+
+  // Import a profile saved by SaveToFile, possibly for a previous build.
+  // The counts of blocks whose hash doesn't match a single block of the image
+  // are dropped.
+  // @param path the path of the profile.
+  // @param weight the factor applied to the counts. Must be positive.
+  // @returns true on success, false otherwise.
+  bool ImportFromFile(const base::FilePath& path, double weight);
+
+  // Scales down the frequencies imported so far, so that they weigh less than
+  // the ones imported next. Counts decaying to zero are dropped.
+  // @param factor the factor applied to the frequencies, between 0 and 1.
+  void Decay(double factor);
+
+  // Saves the frequencies imported so far in a compact binary format, keyed
+  // by block hash. The counts of blocks whose hash isn't unique in the image
+  // are dropped.
+  // @param path the path of the profile.
+  // @returns true on success, false otherwise.
+  bool SaveToFile(const base::FilePath& path) const;
+
  protected:
   // These are protected so that they can be accessed by unittests.
 
+  // Adds a count to a frequency, rounding it and saturating at the largest
+  // EntryCountType.
+  // @param key the frequency to add to.
+  // @param count the count to add. Must not be negative.
+  void AddFrequency(const IndexedFrequencyOffset& key, double count);
+
   // Frequency information for the whole block graph (includes basic block
   // information).
   IndexedFrequencyMap frequencies_;
@@ -14,6 +14,7 @@
 
 #include "syzygy/optimize/application_profile.h"
 
+#include "base/files/scoped_temp_dir.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/basic_block_decomposer.h"
@@ -251,6 +252,66 @@ TEST_F(ApplicationProfileTest, BuildApplicationProfile) {
   EXPECT_EQ(1.0, app.empty_profile_->percentile());
 }
 
+TEST_F(ApplicationProfileTest, CopyBlockProfile) {
+  TestAplicationProfile app(&layout_);
+  IndexedFrequencyMap frequencies;
+  ASSERT_NO_FATAL_FAILURE(PopulateLayout());
+  ASSERT_NO_FATAL_FAILURE(PopulateFrequencies(&frequencies));
+  ASSERT_TRUE(app.ImportFrequencies(frequencies));
+  ASSERT_TRUE(app.ComputeGlobalProfile());
+
+  BlockGraph::Block* new_block1 =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 10, "new_block1");
+  BlockGraph::Block* new_block3 =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 10, "new_block3");
+  EXPECT_EQ(app.empty_profile_.get(), app.GetBlockProfile(new_block1));
+
+  // The profile of an executed block is carried over.
+  app.CopyBlockProfile(block1_->id(), new_block1);
+  const BlockProfile* profile = app.GetBlockProfile(new_block1);
+  ASSERT_NE(app.empty_profile_.get(), profile);
+  EXPECT_EQ(kBlock1Count, profile->count());
+  EXPECT_EQ(kBlock1Count, profile->temperature());
+  EXPECT_EQ(app.GetBlockProfile(block1_)->percentile(), profile->percentile());
+
+  // A block that was never executed has nothing to carry over.
+  app.CopyBlockProfile(block3_->id(), new_block3);
+  EXPECT_EQ(app.empty_profile_.get(), app.GetBlockProfile(new_block3));
+}
+
+TEST_F(ApplicationProfileTest, SplitBlockProfile) {
+  TestAplicationProfile app(&layout_);
+  IndexedFrequencyMap frequencies;
+  ASSERT_NO_FATAL_FAILURE(PopulateLayout());
+  ASSERT_NO_FATAL_FAILURE(PopulateFrequencies(&frequencies));
+  ASSERT_TRUE(app.ImportFrequencies(frequencies));
+  ASSERT_TRUE(app.ComputeGlobalProfile());
+
+  BlockGraph::Block* warm_block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 10, "block2.warm");
+  BlockGraph::Block* cold_block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 10, "block2.cold");
+  BlockGraph::Block* new_block3 =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 10, "block3.warm");
+
+  // A part that ran keeps the entry count of its function, and isn't hot.
+  app.SplitBlockProfile(block2_->id(), warm_block, 3);
+  const BlockProfile* profile = app.GetBlockProfile(warm_block);
+  ASSERT_NE(app.empty_profile_.get(), profile);
+  EXPECT_EQ(kBlock2Count, profile->count());
+  EXPECT_EQ(3, profile->temperature());
+  EXPECT_LE(ApplicationProfile::kHotPercentile, profile->percentile());
+  EXPECT_LE(app.GetBlockProfile(block2_)->percentile(), profile->percentile());
+
+  // A part that never ran has no profile.
+  app.SplitBlockProfile(block2_->id(), cold_block, 0);
+  EXPECT_EQ(app.empty_profile_.get(), app.GetBlockProfile(cold_block));
+
+  // Neither has a part of a block that was never executed.
+  app.SplitBlockProfile(block3_->id(), new_block3, 3);
+  EXPECT_EQ(app.empty_profile_.get(), app.GetBlockProfile(new_block3));
+}
+
 TEST_F(ApplicationProfileTest, ComputeSubGraphProfile) {
   // Build global profile.
   TestAplicationProfile app(&layout_);
@@ -335,4 +396,131 @@ TEST_F(ApplicationProfileTest, RetrieveEmptySubGraphProfile) {
   EXPECT_EQ(0U, bb_profile->count());
 }
 
+TEST_F(ApplicationProfileTest, ImportWeightedFrequencies) {
+  TestAplicationProfile app(&layout_);
+  IndexedFrequencyMap frequencies;
+  ASSERT_NO_FATAL_FAILURE(PopulateLayout());
+  ASSERT_NO_FATAL_FAILURE(PopulateFrequencies(&frequencies));
+  ASSERT_TRUE(app.ImportFrequencies(frequencies));
+  ASSERT_TRUE(app.ImportFrequencies(frequencies, 0.5));
+
+  // The imports are merged, and the weighted counts rounded.
+  IndexedFrequencyMap expected;
+  expected[std::make_pair(RelativeAddress(0x1000), kEntryCountColumn)] = 63;
+  expected[std::make_pair(RelativeAddress(0x2000), kEntryCountColumn)] = 192;
+  expected[std::make_pair(RelativeAddress(0x2002), kEntryCountColumn)] = 384;
+  EXPECT_THAT(expected, ContainerEq(app.frequencies_));
+
+  ASSERT_TRUE(app.ComputeGlobalProfile());
+  EXPECT_EQ(63U, app.GetBlockProfile(block1_)->count());
+  EXPECT_EQ(192U, app.GetBlockProfile(block2_)->count());
+}
+
+TEST_F(ApplicationProfileTest, Decay) {
+  TestAplicationProfile app(&layout_);
+  IndexedFrequencyMap frequencies;
+  ASSERT_NO_FATAL_FAILURE(PopulateLayout());
+  ASSERT_NO_FATAL_FAILURE(PopulateFrequencies(&frequencies));
+  frequencies[std::make_pair(RelativeAddress(0x2004), kEntryCountColumn)] = 1;
+  ASSERT_TRUE(app.ImportFrequencies(frequencies));
+
+  // Counts decaying to zero are dropped.
+  app.Decay(0.25);
+  IndexedFrequencyMap expected;
+  expected[std::make_pair(RelativeAddress(0x1000), kEntryCountColumn)] = 11;
+  expected[std::make_pair(RelativeAddress(0x2000), kEntryCountColumn)] = 32;
+  expected[std::make_pair(RelativeAddress(0x2002), kEntryCountColumn)] = 64;
+  EXPECT_THAT(expected, ContainerEq(app.frequencies_));
+
+  app.Decay(0.0);
+  EXPECT_TRUE(app.frequencies_.empty());
+}
+
+TEST_F(ApplicationProfileTest, ImportHeat) {
+  TestAplicationProfile app(&layout_);
+  ASSERT_NO_FATAL_FAILURE(PopulateLayout());
+
+  // Heat inside block 2, and at the start of block 3.
+  typedef ApplicationProfile::HeatMap HeatMap;
+  HeatMap heat_map;
+  HeatMap::Range range2(RelativeAddress(0x2004), 2);
+  HeatMap::Range range3(RelativeAddress(0x200A), 4);
+  grinder::grinders::SampleGrinder::BasicBlockData data2 = { NULL, NULL, 1.5 };
+  grinder::grinders::SampleGrinder::BasicBlockData data3 = { NULL, NULL, 3.0 };
+  ASSERT_TRUE(heat_map.Insert(range2, data2));
+  ASSERT_TRUE(heat_map.Insert(range3, data3));
+  ASSERT_TRUE(app.ImportHeat(heat_map, 2.0));
+
+  IndexedFrequencyMap expected;
+  expected[std::make_pair(RelativeAddress(0x2000), kEntryCountColumn)] = 1;
+  expected[std::make_pair(RelativeAddress(0x2004), kEntryCountColumn)] = 3;
+  expected[std::make_pair(RelativeAddress(0x200A), kEntryCountColumn)] = 6;
+  EXPECT_THAT(expected, ContainerEq(app.frequencies_));
+
+  // Both sampled blocks count as executed.
+  ASSERT_TRUE(app.ComputeGlobalProfile());
+  EXPECT_EQ(4, app.GetBlockProfile(block2_)->temperature());
+  EXPECT_EQ(6, app.GetBlockProfile(block3_)->temperature());
+  EXPECT_EQ(app.empty_profile_.get(), app.GetBlockProfile(block1_));
+}
+
+TEST_F(ApplicationProfileTest, SaveAndImportFromFile) {
+  TestAplicationProfile app(&layout_);
+  IndexedFrequencyMap frequencies;
+  ASSERT_NO_FATAL_FAILURE(PopulateLayout());
+  ASSERT_NO_FATAL_FAILURE(PopulateFrequencies(&frequencies));
+  ASSERT_NO_FATAL_FAILURE(PopulateSubgraphFrequencies(&frequencies));
+  ASSERT_TRUE(app.ImportFrequencies(frequencies));
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath path = temp_dir.path().Append(L"profile.bin");
+  ASSERT_TRUE(app.SaveToFile(path));
+
+  // Lay out SmallCode at another address in a new build, along with a block
+  // of the same size as blocks 1 to 3.
+  BlockGraph new_block_graph;
+  ImageLayout new_layout(&new_block_graph);
+  BlockGraph::Block* new_block = new_block_graph.AddBlock(
+      BlockGraph::CODE_BLOCK, 10, "new_block");
+  BlockGraph::Block* new_code = new_block_graph.AddBlock(
+      BlockGraph::CODE_BLOCK, sizeof(kSmallCode), "SmallCode");
+  new_code->SetData(kSmallCode, sizeof(kSmallCode));
+  const RelativeAddress kNewCodeAddress(0x5000);
+  new_layout.blocks.InsertBlock(RelativeAddress(0x4000), new_block);
+  new_layout.blocks.InsertBlock(kNewCodeAddress, new_code);
+
+  TestAplicationProfile new_app(&new_layout);
+  ASSERT_TRUE(new_app.ImportFromFile(path, 2.0));
+
+  // The counts of SmallCode follow it, and the others are dropped because
+  // blocks 1 to 3 have the same content.
+  IndexedFrequencyMap expected;
+  expected[std::make_pair(kNewCodeAddress + kBasicBlockOffset0,
+                          kEntryCountColumn)] = 2 * kBasicBlockCount0;
+  expected[std::make_pair(kNewCodeAddress + kBasicBlockOffset1,
+                          kEntryCountColumn)] = 2 * kBasicBlockCount1;
+  expected[std::make_pair(kNewCodeAddress + kBasicBlockOffset2,
+                          kEntryCountColumn)] = 2 * kBasicBlockCount2;
+  expected[std::make_pair(kNewCodeAddress + kBasicBlockOffset0,
+                          kTakenCountColumn)] = 2 * kBasicBlockCount2;
+  expected[std::make_pair(kNewCodeAddress + kBasicBlockOffset0,
+                          kMissPredictedColumn)] = 2 * kBasicBlockCount2;
+  EXPECT_THAT(expected, ContainerEq(new_app.frequencies_));
+
+  ASSERT_TRUE(new_app.ComputeGlobalProfile());
+  EXPECT_EQ(2U * kBasicBlockCount0,
+            new_app.GetBlockProfile(new_code)->count());
+}
+
+TEST_F(ApplicationProfileTest, ImportFromMissingFileFails) {
+  TestAplicationProfile app(&layout_);
+  ASSERT_NO_FATAL_FAILURE(PopulateLayout());
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  EXPECT_FALSE(app.ImportFromFile(temp_dir.path().Append(L"missing.bin"),
+                                  1.0));
+}
+
 }  // namespace optimize
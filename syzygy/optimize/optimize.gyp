@@ -25,12 +25,16 @@
         'optimize_app.h',
         'application_profile.cc',
         'application_profile.h',
+        'orderers/hot_cold_orderer.cc',
+        'orderers/hot_cold_orderer.h',
         'transforms/basic_block_reordering_transform.cc',
         'transforms/basic_block_reordering_transform.h',
         'transforms/block_alignment_transform.cc',
         'transforms/block_alignment_transform.h',
         'transforms/chained_subgraph_transforms.cc',
         'transforms/chained_subgraph_transforms.h',
+        'transforms/function_splitting_transform.cc',
+        'transforms/function_splitting_transform.h',
         'transforms/inlining_transform.cc',
         'transforms/inlining_transform.h',
         'transforms/peephole_transform.cc',
@@ -42,7 +46,11 @@
       'dependencies': [
         '<(src)/base/base.gyp:base',
         '<(src)/syzygy/application/application.gyp:application_lib',
+        '<(src)/syzygy/block_graph/block_graph.gyp:block_graph_lib',
+        '<(src)/syzygy/block_graph/orderers/block_graph_orderers.gyp:'
+            'block_graph_orderers_lib',
         '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
         '<(src)/syzygy/grinder/grinder.gyp:grinder_lib',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/pe/transforms/pe_transforms.gyp:pe_transforms_lib',
@@ -65,9 +73,11 @@
       'sources': [
         'application_profile_unittest.cc',
         'optimize_app_unittest.cc',
+        'orderers/hot_cold_orderer_unittest.cc',
         'transforms/basic_block_reordering_transform_unittest.cc',
         'transforms/block_alignment_transform_unittest.cc',
         'transforms/chained_subgraph_transforms_unittest.cc',
+        'transforms/function_splitting_transform_unittest.cc',
         'transforms/inlining_transform_unittest.cc',
         'transforms/peephole_transform_unittest.cc',
         'transforms/unreachable_block_transform_unittest.cc',
@@ -14,14 +14,20 @@
 
 #include "syzygy/optimize/optimize_app.h"
 
+#include <string>
+
+#include "base/strings/string_number_conversions.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/block_graph/transforms/fuzzing_transform.h"
 #include "syzygy/block_graph/transforms/named_transform.h"
 #include "syzygy/common/indexed_frequency_data.h"
+#include "syzygy/core/phase_profiler.h"
 #include "syzygy/grinder/basic_block_util.h"
 #include "syzygy/optimize/application_profile.h"
+#include "syzygy/optimize/orderers/hot_cold_orderer.h"
 #include "syzygy/optimize/transforms/basic_block_reordering_transform.h"
 #include "syzygy/optimize/transforms/block_alignment_transform.h"
+#include "syzygy/optimize/transforms/function_splitting_transform.h"
 #include "syzygy/optimize/transforms/chained_subgraph_transforms.h"
 #include "syzygy/optimize/transforms/inlining_transform.h"
 #include "syzygy/optimize/transforms/peephole_transform.h"
@@ -37,9 +43,11 @@ using block_graph::transforms::FuzzingTransform;
 using common::IndexedFrequencyData;
 using grinder::basic_block_util::IndexedFrequencyMap;
 using grinder::basic_block_util::LoadBranchStatisticsFromFile;
+using optimize::orderers::HotColdOrderer;
 using optimize::transforms::BasicBlockReorderingTransform;
 using optimize::transforms::BlockAlignmentTransform;
 using optimize::transforms::ChainedSubgraphTransforms;
+using optimize::transforms::FunctionSplittingTransform;
 using optimize::transforms::InliningTransform;
 using optimize::transforms::PeepholeTransform;
 using optimize::transforms::UnreachableBlockTransform;
@@ -54,9 +62,23 @@ const char kUsageFormatStr[] =
     "    --branch-file=<path>  Branch statistics in JSON format.\n"
     "    --input-pdb=<path>    The PDB file associated with the input DLL.\n"
     "                          Default is inferred from input-image.\n"
+    "    --input-profile=<path>\n"
+    "                          A profile saved with --output-profile, maybe\n"
+    "                          for a previous build. It is merged with the\n"
+    "                          branch statistics.\n"
     "    --output-pdb=<path>   Output path for the rewritten PDB file.\n"
     "                          Default is inferred from output-image.\n"
+    "    --output-profile=<path>\n"
+    "                          Save the merged profile, to be merged with the\n"
+    "                          profiles of the next builds.\n"
     "    --overwrite           Allow output files to be overwritten.\n"
+    "    --phase-profile=<path>\n"
+    "                          Write the time and memory taken by each phase\n"
+    "                          of the relink to a JSON file.\n"
+    "    --profile-decay=<factor>\n"
+    "                          The factor, between 0 and 1, by which the\n"
+    "                          counts of --input-profile are scaled down\n"
+    "                          before merging. Default is 1.\n"
     "\n"
     "  Optimization Options:\n"
     "    --all                 Enable all optimizations.\n"
@@ -64,7 +86,20 @@ const char kUsageFormatStr[] =
     "                          Enable the decomposition of inline assembly\n"
     "                          blocks.\n"
     "    --basic-block-reorder Enable basic block reodering.\n"
+    "    --basic-block-layout=<structural|ext-tsp>\n"
+    "                          The layout used by basic block reordering.\n"
+    "                          structural flattens the control flow tree,\n"
+    "                          ext-tsp merges chains of basic blocks to\n"
+    "                          favor fall-throughs and short jumps.\n"
+    "                          Default is structural.\n"
     "    --block-alignment     Enable block realignment.\n"
+    "    --function-splitting  Split the code that seldom or never runs off\n"
+    "                          the executed functions, moving the code never\n"
+    "                          executed to the .ctext section. This enables\n"
+    "                          the hot/cold layout, and orders the hot code\n"
+    "                          by call-graph affinity.\n"
+    "    --hot-cold-layout     Pack the hot code of each section at its head\n"
+    "                          and move the code never executed to its tail.\n"
     "    --inlining            Enable function inlining.\n"
     "    --peephole            Enable peephole optimization.\n"
     "    --unreachable-block   Enable unreachable block optimization.\n"
@@ -88,10 +123,32 @@ bool OptimizeApp::ParseCommandLine(const base::CommandLine* cmd_line) {
   input_pdb_path_ = AbsolutePath(cmd_line->GetSwitchValuePath("input-pdb"));
   output_pdb_path_ = cmd_line->GetSwitchValuePath("output-pdb");
   branch_file_path_ = AbsolutePath(cmd_line->GetSwitchValuePath("branch-file"));
+  phase_profile_path_ = cmd_line->GetSwitchValuePath("phase-profile");
+  input_profile_path_ =
+      AbsolutePath(cmd_line->GetSwitchValuePath("input-profile"));
+  output_profile_path_ =
+      AbsolutePath(cmd_line->GetSwitchValuePath("output-profile"));
+  if (cmd_line->HasSwitch("profile-decay")) {
+    std::string decay = cmd_line->GetSwitchValueASCII("profile-decay");
+    if (!base::StringToDouble(decay, &profile_decay_) ||
+        profile_decay_ <= 0.0 || profile_decay_ > 1.0) {
+      return Usage(cmd_line, "Invalid profile decay.");
+    }
+    if (input_profile_path_.empty())
+      return Usage(cmd_line, "--profile-decay requires --input-profile.");
+  }
 
   basic_block_reorder_ = cmd_line->HasSwitch("basic-block-reorder");
+  std::string layout = cmd_line->GetSwitchValueASCII("basic-block-layout");
+  if (layout == "ext-tsp") {
+    ext_tsp_layout_ = true;
+  } else if (!layout.empty() && layout != "structural") {
+    return Usage(cmd_line, "Unknown basic block layout.");
+  }
   block_alignment_ = cmd_line->HasSwitch("block-alignment");
   fuzz_ = cmd_line->HasSwitch("fuzz");
+  function_splitting_ = cmd_line->HasSwitch("function-splitting");
+  hot_cold_layout_ = cmd_line->HasSwitch("hot-cold-layout");
   inlining_ = cmd_line->HasSwitch("inlining");
   allow_inline_assembly_ = cmd_line->HasSwitch("allow-inline-assembly");
   peephole_ = cmd_line->HasSwitch("peephole");
@@ -102,6 +159,8 @@ bool OptimizeApp::ParseCommandLine(const base::CommandLine* cmd_line) {
   if (cmd_line->HasSwitch("all")) {
     basic_block_reorder_ = true;
     block_alignment_ = true;
+    function_splitting_ = true;
+    hot_cold_layout_ = true;
     inlining_ = true;
     peephole_ = true;
     unreachable_block_ = true;
@@ -128,6 +187,12 @@ bool OptimizeApp::SetUp() {
 }
 
 int OptimizeApp::Run() {
+  // Profile the phases of the relink if asked to.
+  core::PhaseProfiler profiler;
+  std::unique_ptr<core::PhaseProfiler::ScopedCurrent> scoped_profiler;
+  if (!phase_profile_path_.empty())
+    scoped_profiler.reset(new core::PhaseProfiler::ScopedCurrent(&profiler));
+
   pe::PETransformPolicy policy;
   policy.set_allow_inline_assembly(allow_inline_assembly_);
   pe::PERelinker relinker(&policy);
@@ -148,8 +213,17 @@ int OptimizeApp::Run() {
   relinker.input_pe_file().GetSignature(&signature);
   const pe::ImageLayout& image_layout = relinker.input_image_layout();
 
-  // Load profile information from file.
+  // Load profile information from file. The saved profile is decayed before
+  // the fresher branch statistics are merged into it.
   ApplicationProfile profile(&image_layout);
+  if (!input_profile_path_.empty()) {
+    if (!profile.ImportFromFile(input_profile_path_, 1.0)) {
+      LOG(ERROR) << "Could not import profile '"
+                 << input_profile_path_.value() << "'.";
+      return 1;
+    }
+    profile.Decay(profile_decay_);
+  }
   if (!branch_file_path_.empty()) {
     IndexedFrequencyMap frequencies;
     if (!LoadBranchStatisticsFromFile(branch_file_path_,
@@ -164,6 +238,12 @@ int OptimizeApp::Run() {
       return false;
     }
   }
+  if (!output_profile_path_.empty() &&
+      !profile.SaveToFile(output_profile_path_)) {
+    LOG(ERROR) << "Could not save profile '" << output_profile_path_.value()
+               << "'.";
+    return 1;
+  }
 
   // Compute global profile information for the current block graph.
   if (!profile.ComputeGlobalProfile()) {
@@ -178,6 +258,7 @@ int OptimizeApp::Run() {
   std::unique_ptr<BasicBlockReorderingTransform>
       basic_block_reordering_transform;
   std::unique_ptr<BlockAlignmentTransform> block_alignment_transform;
+  std::unique_ptr<FunctionSplittingTransform> function_splitting_transform;
   std::unique_ptr<FuzzingTransform> fuzzing_transform;
   std::unique_ptr<InliningTransform> inlining_transform;
   std::unique_ptr<PeepholeTransform> peephole_transform;
@@ -198,9 +279,20 @@ int OptimizeApp::Run() {
   // If block block reordering is enabled, add it to the chain.
   if (basic_block_reorder_) {
     basic_block_reordering_transform.reset(new BasicBlockReorderingTransform());
+    if (ext_tsp_layout_) {
+      basic_block_reordering_transform->set_layout(
+          BasicBlockReorderingTransform::kExtTspLayout);
+    }
     chains.AppendTransform(basic_block_reordering_transform.get());
   }
 
+  // If function splitting is enabled, add it to the chain. This comes after
+  // the basic blocks are reordered, and before the hot parts are aligned.
+  if (function_splitting_) {
+    function_splitting_transform.reset(new FunctionSplittingTransform());
+    chains.AppendTransform(function_splitting_transform.get());
+  }
+
   // If block alignment is enabled, add it to the chain.
   if (block_alignment_) {
     block_alignment_transform.reset(new BlockAlignmentTransform());
@@ -225,12 +317,27 @@ int OptimizeApp::Run() {
     relinker.AppendTransform(fuzzing_transform.get());
   }
 
+  // If hot/cold layout is enabled, order the blocks by temperature. This
+  // replaces the default orderer of the relinker. The hot parts of split
+  // functions are laid out by call-graph affinity.
+  std::unique_ptr<HotColdOrderer> hot_cold_orderer;
+  if (hot_cold_layout_ || function_splitting_) {
+    hot_cold_orderer.reset(new HotColdOrderer(&profile));
+    hot_cold_orderer->set_call_graph_affinity(function_splitting_);
+    relinker.AppendOrderer(hot_cold_orderer.get());
+  }
+
   // Perform the actual relink.
   if (!relinker.Relink()) {
     LOG(ERROR) << "Unable to relink input image.";
     return 1;
   }
 
+  if (!phase_profile_path_.empty() &&
+      !profiler.SaveToJSON(phase_profile_path_, true)) {
+    return 1;
+  }
+
   return 0;
 }
 
@@ -33,12 +33,16 @@ class OptimizeApp : public application::AppImplBase {
       : AppImplBase("Optimize"),
         basic_block_reorder_(false),
         block_alignment_(false),
+        ext_tsp_layout_(false),
+        function_splitting_(false),
         fuzz_(false),
+        hot_cold_layout_(false),
         inlining_(false),
         allow_inline_assembly_(false),
         overwrite_(false),
         peephole_(false),
-        unreachable_block_(false) {
+        unreachable_block_(false),
+        profile_decay_(1.0) {
   }
 
   // @name Implementation of the AppImplBase interface.
@@ -62,15 +66,22 @@ class OptimizeApp : public application::AppImplBase {
   base::FilePath output_image_path_;
   base::FilePath output_pdb_path_;
   base::FilePath branch_file_path_;
+  base::FilePath input_profile_path_;
+  base::FilePath output_profile_path_;
   base::FilePath unreachable_graph_path_;
+  base::FilePath phase_profile_path_;
   bool block_alignment_;
   bool basic_block_reorder_;
+  bool ext_tsp_layout_;
+  bool function_splitting_;
   bool fuzz_;
+  bool hot_cold_layout_;
   bool inlining_;
   bool allow_inline_assembly_;
   bool peephole_;
   bool unreachable_block_;
   bool overwrite_;
+  double profile_decay_;
   // @}
 
  private:
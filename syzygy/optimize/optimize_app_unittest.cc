@@ -36,10 +36,16 @@ class TestOptimizeApp : public OptimizeApp {
   using OptimizeApp::output_image_path_;
   using OptimizeApp::output_pdb_path_;
   using OptimizeApp::branch_file_path_;
+  using OptimizeApp::input_profile_path_;
+  using OptimizeApp::output_profile_path_;
+  using OptimizeApp::profile_decay_;
   using OptimizeApp::unreachable_graph_path_;
   using OptimizeApp::basic_block_reorder_;
   using OptimizeApp::block_alignment_;
+  using OptimizeApp::ext_tsp_layout_;
+  using OptimizeApp::function_splitting_;
   using OptimizeApp::fuzz_;
+  using OptimizeApp::hot_cold_layout_;
   using OptimizeApp::inlining_;
   using OptimizeApp::allow_inline_assembly_;
   using OptimizeApp::peephole_;
@@ -160,8 +166,11 @@ TEST_F(OptimizeAppTest, ParseMinimalCommandLineWithBranchFile) {
   EXPECT_FALSE(test_impl_.allow_inline_assembly_);
   EXPECT_FALSE(test_impl_.block_alignment_);
   EXPECT_FALSE(test_impl_.basic_block_reorder_);
+  EXPECT_FALSE(test_impl_.ext_tsp_layout_);
   EXPECT_FALSE(test_impl_.peephole_);
   EXPECT_FALSE(test_impl_.fuzz_);
+  EXPECT_FALSE(test_impl_.function_splitting_);
+  EXPECT_FALSE(test_impl_.hot_cold_layout_);
 
   EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
   EXPECT_TRUE(test_impl_.SetUp());
@@ -185,6 +194,42 @@ TEST_F(OptimizeAppTest, ParseFullCommandLineWithBranchFile) {
   EXPECT_TRUE(test_impl_.SetUp());
 }
 
+TEST_F(OptimizeAppTest, ParseCommandLineWithProfiles) {
+  base::FilePath input_profile_path = temp_dir_.Append(L"input_profile.bin");
+  base::FilePath output_profile_path = temp_dir_.Append(L"output_profile.bin");
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchPath("branch-file", branch_file_path_);
+  cmd_line_.AppendSwitchPath("input-profile", input_profile_path);
+  cmd_line_.AppendSwitchPath("output-profile", output_profile_path);
+  cmd_line_.AppendSwitchASCII("profile-decay", "0.5");
+
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(input_profile_path, test_impl_.input_profile_path_);
+  EXPECT_EQ(output_profile_path, test_impl_.output_profile_path_);
+  EXPECT_EQ(0.5, test_impl_.profile_decay_);
+
+  EXPECT_TRUE(test_impl_.SetUp());
+}
+
+TEST_F(OptimizeAppTest, ParseCommandLineWithInvalidProfileDecayFails) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchPath("input-profile",
+                             temp_dir_.Append(L"input_profile.bin"));
+  cmd_line_.AppendSwitchASCII("profile-decay", "1.5");
+
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(OptimizeAppTest, ParseCommandLineWithProfileDecayOnlyFails) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchASCII("profile-decay", "0.5");
+
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(OptimizeAppTest, ParseFullCommandLineWithInputAndOutputPdb) {
   cmd_line_.AppendSwitchPath("input-image", input_image_path_);
   cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
@@ -197,6 +242,8 @@ TEST_F(OptimizeAppTest, ParseFullCommandLineWithInputAndOutputPdb) {
   cmd_line_.AppendSwitch("basic-block-reorder");
   cmd_line_.AppendSwitch("peephole");
   cmd_line_.AppendSwitch("fuzz");
+  cmd_line_.AppendSwitch("function-splitting");
+  cmd_line_.AppendSwitch("hot-cold-layout");
 
   EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
   EXPECT_EQ(abs_input_image_path_, test_impl_.input_image_path_);
@@ -210,6 +257,8 @@ TEST_F(OptimizeAppTest, ParseFullCommandLineWithInputAndOutputPdb) {
   EXPECT_TRUE(test_impl_.basic_block_reorder_);
   EXPECT_TRUE(test_impl_.peephole_);
   EXPECT_TRUE(test_impl_.fuzz_);
+  EXPECT_TRUE(test_impl_.function_splitting_);
+  EXPECT_TRUE(test_impl_.hot_cold_layout_);
 
   EXPECT_TRUE(test_impl_.SetUp());
 }
@@ -233,11 +282,35 @@ TEST_F(OptimizeAppTest, ParseAllCommandLineWithInputAndOutputPdb) {
   EXPECT_TRUE(test_impl_.basic_block_reorder_);
   EXPECT_TRUE(test_impl_.block_alignment_);
   EXPECT_TRUE(test_impl_.peephole_);
+  EXPECT_TRUE(test_impl_.function_splitting_);
+  EXPECT_TRUE(test_impl_.hot_cold_layout_);
   EXPECT_FALSE(test_impl_.fuzz_);
 
   EXPECT_TRUE(test_impl_.SetUp());
 }
 
+TEST_F(OptimizeAppTest, ParseCommandLineWithExtTspLayout) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitch("basic-block-reorder");
+  cmd_line_.AppendSwitchASCII("basic-block-layout", "ext-tsp");
+  cmd_line_.AppendSwitch("overwrite");
+
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_TRUE(test_impl_.basic_block_reorder_);
+  EXPECT_TRUE(test_impl_.ext_tsp_layout_);
+
+  EXPECT_TRUE(test_impl_.SetUp());
+}
+
+TEST_F(OptimizeAppTest, ParseCommandLineWithUnknownLayoutFails) {
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchASCII("basic-block-layout", "random");
+
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(OptimizeAppTest, ParseCommandLineWithUnreachableGraph) {
   cmd_line_.AppendSwitchPath("input-image", input_image_path_);
   cmd_line_.AppendSwitchPath("output-image", output_image_path_);
@@ -0,0 +1,250 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/optimize/orderers/hot_cold_orderer.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "syzygy/block_graph/orderers/original_orderer.h"
+
+namespace optimize {
+namespace orderers {
+
+namespace {
+
+using block_graph::BlockGraph;
+using block_graph::BlockVector;
+using block_graph::OrderedBlockGraph;
+
+typedef ApplicationProfile::BlockProfile BlockProfile;
+
+// Orders blocks hottest first, breaking ties with the entry count. Used with
+// a stable sort, so that equally hot blocks keep their original order.
+struct HotterBlockFunctor {
+  explicit HotterBlockFunctor(const ApplicationProfile* profile)
+      : profile(profile) {
+  }
+
+  bool operator()(const BlockGraph::Block* block1,
+                  const BlockGraph::Block* block2) const {
+    const BlockProfile* profile1 = profile->GetBlockProfile(block1);
+    const BlockProfile* profile2 = profile->GetBlockProfile(block2);
+    if (profile1->temperature() != profile2->temperature())
+      return profile1->temperature() > profile2->temperature();
+    return profile1->count() > profile2->count();
+  }
+
+  const ApplicationProfile* profile;
+};
+
+// A call-graph edge between two hot blocks, given by their indices.
+typedef std::pair<size_t, size_t> Edge;
+typedef std::map<Edge, double> EdgeWeightMap;
+typedef std::vector<size_t> Chain;
+
+// Orders call-graph edges heaviest first, breaking ties with the indices of
+// their blocks so that the ordering is deterministic.
+struct HeavierEdgeFunctor {
+  bool operator()(const EdgeWeightMap::value_type& edge1,
+                  const EdgeWeightMap::value_type& edge2) const {
+    if (edge1.second != edge2.second)
+      return edge1.second > edge2.second;
+    return edge1.first < edge2.first;
+  }
+};
+
+// Lays out two chains next to each other, in the orientation that brings
+// their elements @p first and @p second the closest.
+// @param first an element of @p chain1.
+// @param second an element of @p chain2.
+// @param chain1 the first chain, which receives the merged chain.
+// @param chain2 the second chain, which is emptied.
+void MergeChains(size_t first, size_t second, Chain* chain1, Chain* chain2) {
+  DCHECK_NE(reinterpret_cast<Chain*>(NULL), chain1);
+  DCHECK_NE(reinterpret_cast<Chain*>(NULL), chain2);
+
+  size_t size1 = chain1->size();
+  size_t size2 = chain2->size();
+  size_t pos1 = std::find(chain1->begin(), chain1->end(), first) -
+      chain1->begin();
+  size_t pos2 = std::find(chain2->begin(), chain2->end(), second) -
+      chain2->begin();
+  DCHECK_LT(pos1, size1);
+  DCHECK_LT(pos2, size2);
+
+  // The distances between the two elements when the chains are laid out as
+  // 1-2, 1-reversed 2, reversed 1-2, and 2-1.
+  size_t distances[] = { size1 - 1 - pos1 + pos2,
+                         size1 - 1 - pos1 + size2 - 1 - pos2,
+                         pos1 + pos2,
+                         size2 - 1 - pos2 + pos1 };
+  size_t best =
+      std::min_element(distances, distances + arraysize(distances)) -
+      distances;
+
+  if (best == 1) {
+    std::reverse(chain2->begin(), chain2->end());
+  } else if (best == 2) {
+    std::reverse(chain1->begin(), chain1->end());
+  } else if (best == 3) {
+    chain1->swap(*chain2);
+  }
+  chain1->insert(chain1->end(), chain2->begin(), chain2->end());
+  chain2->clear();
+}
+
+// Orders hot blocks by call-graph affinity, following Pettis and Hansen. The
+// edges of the call graph are the references between the blocks, weighted by
+// the smaller of their entry counts. The chains of blocks are merged along
+// the heaviest edges first, and are laid out by their hottest block.
+// @param profile the profile of the blocks.
+// @param hot_blocks the hot blocks, hottest first. Receives the new order.
+void OrderByCallGraphAffinity(const ApplicationProfile* profile,
+                              BlockVector* hot_blocks) {
+  DCHECK_NE(reinterpret_cast<const ApplicationProfile*>(NULL), profile);
+  DCHECK_NE(reinterpret_cast<BlockVector*>(NULL), hot_blocks);
+
+  std::map<const BlockGraph::Block*, size_t> indices;
+  for (size_t i = 0; i < hot_blocks->size(); ++i)
+    indices[(*hot_blocks)[i]] = i;
+
+  // Weigh the edges between the hot blocks.
+  EdgeWeightMap weights;
+  for (size_t i = 0; i < hot_blocks->size(); ++i) {
+    const BlockGraph::Block* block = (*hot_blocks)[i];
+    BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+        block->references().begin();
+    for (; ref_it != block->references().end(); ++ref_it) {
+      std::map<const BlockGraph::Block*, size_t>::const_iterator index_it =
+          indices.find(ref_it->second.referenced());
+      if (index_it == indices.end() || index_it->second == i)
+        continue;
+
+      const BlockGraph::Block* referenced = index_it->first;
+      Edge edge(std::min(i, index_it->second), std::max(i, index_it->second));
+      weights[edge] += std::min(profile->GetBlockProfile(block)->count(),
+                                profile->GetBlockProfile(referenced)->count());
+    }
+  }
+  std::vector<EdgeWeightMap::value_type> edges(weights.begin(), weights.end());
+  std::sort(edges.begin(), edges.end(), HeavierEdgeFunctor());
+
+  // Each block starts in a chain of its own.
+  std::vector<Chain> chains(hot_blocks->size());
+  std::vector<size_t> chain_ids(hot_blocks->size());
+  for (size_t i = 0; i < hot_blocks->size(); ++i) {
+    chains[i].push_back(i);
+    chain_ids[i] = i;
+  }
+
+  for (size_t i = 0; i < edges.size(); ++i) {
+    size_t first = edges[i].first.first;
+    size_t second = edges[i].first.second;
+    size_t chain1 = chain_ids[first];
+    size_t chain2 = chain_ids[second];
+    if (chain1 == chain2)
+      continue;
+
+    for (size_t j = 0; j < chains[chain2].size(); ++j)
+      chain_ids[chains[chain2][j]] = chain1;
+    MergeChains(first, second, &chains[chain1], &chains[chain2]);
+  }
+
+  // The blocks are indexed hottest first, so the hottest block of a chain is
+  // its smallest index.
+  std::vector<std::pair<size_t, size_t>> chain_order;
+  for (size_t i = 0; i < chains.size(); ++i) {
+    if (!chains[i].empty()) {
+      size_t hottest = *std::min_element(chains[i].begin(), chains[i].end());
+      chain_order.push_back(std::make_pair(hottest, i));
+    }
+  }
+  std::sort(chain_order.begin(), chain_order.end());
+
+  BlockVector ordered_blocks;
+  for (size_t i = 0; i < chain_order.size(); ++i) {
+    const Chain& chain = chains[chain_order[i].second];
+    for (size_t j = 0; j < chain.size(); ++j)
+      ordered_blocks.push_back((*hot_blocks)[chain[j]]);
+  }
+  hot_blocks->swap(ordered_blocks);
+}
+
+}  // namespace
+
+const char HotColdOrderer::kOrdererName[] = "HotColdOrderer";
+
+HotColdOrderer::HotColdOrderer(const ApplicationProfile* profile)
+    : profile_(profile), call_graph_affinity_(false) {
+  DCHECK_NE(reinterpret_cast<const ApplicationProfile*>(NULL), profile);
+}
+
+bool HotColdOrderer::OrderBlockGraph(OrderedBlockGraph* ordered_block_graph,
+                                     BlockGraph::Block* header_block) {
+  DCHECK_NE(reinterpret_cast<OrderedBlockGraph*>(NULL), ordered_block_graph);
+  DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), header_block);
+
+  // Start from the original ordering. This orders the sections, and the
+  // blocks that aren't moved below stay where they were in the input image.
+  block_graph::orderers::OriginalOrderer original_orderer;
+  if (!original_orderer.OrderBlockGraph(ordered_block_graph, header_block))
+    return false;
+
+  const BlockGraph* bg = ordered_block_graph->block_graph();
+  BlockGraph::SectionMap::const_iterator section_it = bg->sections().begin();
+  for (; section_it != bg->sections().end(); ++section_it) {
+    const BlockGraph::Section* section = &section_it->second;
+
+    // Split the code blocks of the section by temperature. The blocks are
+    // moved once they are all classified, as moving them alters the list.
+    BlockVector hot_blocks;
+    BlockVector cold_blocks;
+    const OrderedBlockGraph::BlockList& blocks =
+        ordered_block_graph->ordered_section(section).ordered_blocks();
+    OrderedBlockGraph::BlockList::const_iterator block_it = blocks.begin();
+    for (; block_it != blocks.end(); ++block_it) {
+      BlockGraph::Block* block = *block_it;
+      if (block->type() != BlockGraph::CODE_BLOCK)
+        continue;
+
+      const BlockProfile* block_profile = profile_->GetBlockProfile(block);
+      if (block_profile->count() == 0)
+        cold_blocks.push_back(block);
+      else if (block_profile->percentile() < ApplicationProfile::kHotPercentile)
+        hot_blocks.push_back(block);
+    }
+
+    // Code that never ran goes last, in its original order.
+    for (size_t i = 0; i < cold_blocks.size(); ++i)
+      ordered_block_graph->PlaceAtTail(section, cold_blocks[i]);
+
+    // Hot code goes first, hottest first. The blocks are placed in reverse
+    // since each one is placed ahead of the previous one.
+    std::stable_sort(hot_blocks.begin(), hot_blocks.end(),
+                     HotterBlockFunctor(profile_));
+    if (call_graph_affinity_)
+      OrderByCallGraphAffinity(profile_, &hot_blocks);
+    BlockVector::reverse_iterator hot_it = hot_blocks.rbegin();
+    for (; hot_it != hot_blocks.rend(); ++hot_it)
+      ordered_block_graph->PlaceAtHead(section, *hot_it);
+  }
+
+  return true;
+}
+
+}  // namespace orderers
+}  // namespace optimize
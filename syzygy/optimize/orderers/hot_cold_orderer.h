@@ -0,0 +1,82 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares an orderer that uses an application profile to pack the hot code
+// of each section together. Starting from the original ordering, the code
+// blocks of each section are laid out as follows:
+//
+//   1. Hot blocks, hottest first, at the head of the section. These are the
+//      executed blocks below ApplicationProfile::kHotPercentile.
+//   2. The remaining executed blocks, in their original order, along with
+//      the data blocks of the section.
+//   3. Code blocks that were never executed, in their original order, at the
+//      tail of the section.
+//
+// The hot code thus shares as few pages and cache lines as possible with code
+// that is rarely or never run. With call-graph affinity, the hot blocks are
+// instead laid out in chains of blocks referring to each other, following
+// Pettis and Hansen, so that callers and their callees share pages.
+
+#ifndef SYZYGY_OPTIMIZE_ORDERERS_HOT_COLD_ORDERER_H_
+#define SYZYGY_OPTIMIZE_ORDERERS_HOT_COLD_ORDERER_H_
+
+#include "syzygy/block_graph/orderers/named_orderer.h"
+#include "syzygy/optimize/application_profile.h"
+
+namespace optimize {
+namespace orderers {
+
+class HotColdOrderer
+    : public block_graph::orderers::NamedOrdererImpl<HotColdOrderer> {
+ public:
+  typedef block_graph::BlockGraph BlockGraph;
+  typedef block_graph::OrderedBlockGraph OrderedBlockGraph;
+
+  // Constructor.
+  // @param profile The profile of the blocks to order.
+  // @note |profile| must outlive this orderer.
+  explicit HotColdOrderer(const ApplicationProfile* profile);
+
+  // @name Accessors.
+  // @{
+  bool call_graph_affinity() const { return call_graph_affinity_; }
+  void set_call_graph_affinity(bool call_graph_affinity) {
+    call_graph_affinity_ = call_graph_affinity;
+  }
+  // @}
+
+  // Applies this orderer to the provided block graph.
+  //
+  // @param ordered_block_graph the block graph to order.
+  // @param header_block The header block of the block graph to transform.
+  // @returns true on success, false otherwise.
+  virtual bool OrderBlockGraph(OrderedBlockGraph* ordered_block_graph,
+                               BlockGraph::Block* header_block) override;
+
+  static const char kOrdererName[];
+
+ private:
+  const ApplicationProfile* profile_;
+
+  // Indicates whether the hot blocks are ordered by call-graph affinity
+  // rather than by temperature alone.
+  bool call_graph_affinity_;
+
+  DISALLOW_COPY_AND_ASSIGN(HotColdOrderer);
+};
+
+}  // namespace orderers
+}  // namespace optimize
+
+#endif  // SYZYGY_OPTIMIZE_ORDERERS_HOT_COLD_ORDERER_H_
@@ -0,0 +1,168 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/optimize/orderers/hot_cold_orderer.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace optimize {
+namespace orderers {
+
+namespace {
+
+using block_graph::BlockGraph;
+using block_graph::OrderedBlockGraph;
+using testing::ElementsAreArray;
+
+typedef ApplicationProfile::BlockProfile BlockProfile;
+
+class TestApplicationProfile : public ApplicationProfile {
+ public:
+  using ApplicationProfile::profiles_;
+
+  explicit TestApplicationProfile(const ImageLayout* layout)
+      : ApplicationProfile(layout) {
+  }
+};
+
+class HotColdOrdererTest : public testing::Test {
+ public:
+  HotColdOrdererTest() : image_(&block_graph_), profile_(&image_) {
+  }
+
+  void SetUp() override {
+    section_ = block_graph_.AddSection(".text", 0);
+    header_ = block_graph_.AddBlock(BlockGraph::DATA_BLOCK, 10, "header");
+  }
+
+  // Adds a block to the section, at @p src_addr in the original image.
+  BlockGraph::Block* AddBlock(BlockGraph::BlockType type,
+                              const char* name,
+                              size_t src_addr) {
+    BlockGraph::Block* block = block_graph_.AddBlock(type, 10, name);
+    block->source_ranges().Push(
+        BlockGraph::Block::DataRange(0, block->size()),
+        BlockGraph::Block::SourceRange(BlockGraph::RelativeAddress(src_addr),
+                                       block->size()));
+    block->set_section(section_->id());
+    // Make the data non-zero so that the block isn't sent to the end of the
+    // section as implicitly initialized.
+    block->AllocateData(block->size())[0] = 1;
+    return block;
+  }
+
+  // Sets the profile of @p block.
+  void SetProfile(const BlockGraph::Block* block,
+                  size_t count,
+                  double temperature,
+                  double percentile) {
+    BlockProfile block_profile(count, temperature);
+    block_profile.set_percentile(percentile);
+    profile_.profiles_[block->id()] = block_profile;
+  }
+
+ protected:
+  BlockGraph block_graph_;
+  pe::ImageLayout image_;
+  TestApplicationProfile profile_;
+  BlockGraph::Section* section_;
+  BlockGraph::Block* header_;
+};
+
+}  // namespace
+
+TEST_F(HotColdOrdererTest, HotBlocksFirstAndColdBlocksLast) {
+  BlockGraph::Block* cold1 = AddBlock(BlockGraph::CODE_BLOCK, "cold1", 0x1000);
+  BlockGraph::Block* hot1 = AddBlock(BlockGraph::CODE_BLOCK, "hot1", 0x1010);
+  BlockGraph::Block* warm1 = AddBlock(BlockGraph::CODE_BLOCK, "warm1", 0x1020);
+  BlockGraph::Block* data = AddBlock(BlockGraph::DATA_BLOCK, "data", 0x1030);
+  BlockGraph::Block* hot2 = AddBlock(BlockGraph::CODE_BLOCK, "hot2", 0x1040);
+  BlockGraph::Block* cold2 = AddBlock(BlockGraph::CODE_BLOCK, "cold2", 0x1050);
+  BlockGraph::Block* warm2 = AddBlock(BlockGraph::CODE_BLOCK, "warm2", 0x1060);
+
+  // hot2 is hotter than hot1. The warm blocks are executed, but above the
+  // hot percentile. The cold blocks have no profile.
+  SetProfile(hot1, 10, 20.0, 0.6);
+  SetProfile(hot2, 100, 500.0, 0.0);
+  SetProfile(warm1, 1, 1.0, 0.95);
+  SetProfile(warm2, 2, 2.0, 0.92);
+
+  OrderedBlockGraph obg(&block_graph_);
+  HotColdOrderer orderer(&profile_);
+  EXPECT_TRUE(orderer.OrderBlockGraph(&obg, header_));
+
+  BlockGraph::Block* expected[] = { hot2, hot1, warm1, data, warm2, cold1,
+                                    cold2 };
+  EXPECT_THAT(obg.ordered_section(section_).ordered_blocks(),
+              ElementsAreArray(expected));
+}
+
+TEST_F(HotColdOrdererTest, CallGraphAffinity) {
+  BlockGraph::Block* hot1 = AddBlock(BlockGraph::CODE_BLOCK, "hot1", 0x1000);
+  BlockGraph::Block* hot2 = AddBlock(BlockGraph::CODE_BLOCK, "hot2", 0x1010);
+  BlockGraph::Block* hot3 = AddBlock(BlockGraph::CODE_BLOCK, "hot3", 0x1020);
+  BlockGraph::Block* hot4 = AddBlock(BlockGraph::CODE_BLOCK, "hot4", 0x1030);
+  BlockGraph::Block* cold = AddBlock(BlockGraph::CODE_BLOCK, "cold", 0x1040);
+  SetProfile(hot1, 100, 400.0, 0.0);
+  SetProfile(hot2, 50, 300.0, 0.2);
+  SetProfile(hot3, 40, 200.0, 0.4);
+  SetProfile(hot4, 30, 100.0, 0.6);
+
+  // hot3 calls hot1 and hot4 calls hot2. The call to the cold block doesn't
+  // bring it along.
+  BlockGraph::Reference ref1(BlockGraph::PC_RELATIVE_REF, 4, hot1, 0, 0);
+  BlockGraph::Reference ref2(BlockGraph::PC_RELATIVE_REF, 4, hot2, 0, 0);
+  BlockGraph::Reference ref3(BlockGraph::PC_RELATIVE_REF, 4, cold, 0, 0);
+  ASSERT_TRUE(hot3->SetReference(1, ref1));
+  ASSERT_TRUE(hot4->SetReference(1, ref2));
+  ASSERT_TRUE(hot1->SetReference(1, ref3));
+
+  HotColdOrderer orderer(&profile_);
+  EXPECT_FALSE(orderer.call_graph_affinity());
+
+  OrderedBlockGraph obg1(&block_graph_);
+  EXPECT_TRUE(orderer.OrderBlockGraph(&obg1, header_));
+  BlockGraph::Block* expected1[] = { hot1, hot2, hot3, hot4, cold };
+  EXPECT_THAT(obg1.ordered_section(section_).ordered_blocks(),
+              ElementsAreArray(expected1));
+
+  // The callers are laid out next to their callees.
+  orderer.set_call_graph_affinity(true);
+  EXPECT_TRUE(orderer.call_graph_affinity());
+  OrderedBlockGraph obg2(&block_graph_);
+  EXPECT_TRUE(orderer.OrderBlockGraph(&obg2, header_));
+  BlockGraph::Block* expected2[] = { hot1, hot3, hot2, hot4, cold };
+  EXPECT_THAT(obg2.ordered_section(section_).ordered_blocks(),
+              ElementsAreArray(expected2));
+}
+
+TEST_F(HotColdOrdererTest, NoProfileKeepsDataInOriginalOrder) {
+  BlockGraph::Block* data1 = AddBlock(BlockGraph::DATA_BLOCK, "data1", 0x20);
+  BlockGraph::Block* data2 = AddBlock(BlockGraph::DATA_BLOCK, "data2", 0x10);
+  BlockGraph::Block* code1 = AddBlock(BlockGraph::CODE_BLOCK, "code1", 0x30);
+  BlockGraph::Block* code2 = AddBlock(BlockGraph::CODE_BLOCK, "code2", 0x00);
+
+  OrderedBlockGraph obg(&block_graph_);
+  HotColdOrderer orderer(&profile_);
+  EXPECT_TRUE(orderer.OrderBlockGraph(&obg, header_));
+
+  // Without a profile all code is cold, and goes after the data.
+  BlockGraph::Block* expected[] = { data2, data1, code2, code1 };
+  EXPECT_THAT(obg.ordered_section(section_).ordered_blocks(),
+              ElementsAreArray(expected));
+}
+
+}  // namespace orderers
+}  // namespace optimize
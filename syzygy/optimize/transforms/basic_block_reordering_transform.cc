@@ -14,6 +14,10 @@
 
 #include "syzygy/optimize/transforms/basic_block_reordering_transform.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
+
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/optimize/application_profile.h"
 
@@ -34,6 +38,43 @@ typedef ControlFlowAnalysis::StructuralNode StructuralNode;
 typedef SubGraphProfile::BasicBlockProfile BasicBlockProfile;
 typedef grinder::basic_block_util::EntryCountType EntryCountType;
 
+// @name The parameters of the Ext-TSP score. A jump scores its count times
+//     kFallThroughWeight when it falls through. Otherwise it scores a fraction
+//     of kForwardWeight or kBackwardWeight, which decreases linearly with its
+//     distance and reaches zero at kForwardDistance or kBackwardDistance.
+// @{
+const double kFallThroughWeight = 1.0;
+const double kForwardWeight = 0.1;
+const double kBackwardWeight = 0.1;
+const size_t kForwardDistance = 1024;
+const size_t kBackwardDistance = 640;
+// @}
+
+// The estimated size of a branch. The final size of the successors of a basic
+// block depends on the layout, and most jumps within a function are short.
+const size_t kBranchSizeEstimate = 2;
+
+// Chains longer than this are only merged whole, without trying to split them.
+const size_t kChainSplitThreshold = 128;
+
+// Functions with more basic blocks than this are left alone, the cost of the
+// layout growing faster than the square of their size.
+const size_t kMaxExtTspBasicBlockCount = 1024;
+
+// A jump of an Ext-TSP graph.
+struct ExtTspJump {
+  size_t target;
+  EntryCountType count;
+};
+
+// The basic blocks and profiled jumps a layout is computed over. The basic
+// blocks are identified by their index in the original order.
+struct ExtTspGraph {
+  std::vector<size_t> sizes;
+  std::vector<EntryCountType> counts;
+  std::vector<std::vector<ExtTspJump>> jumps;
+};
+
 // A helper to "cast" the given successor as a BasicCodeBlock.
 const BasicCodeBlock* GetSuccessorBB(const Successor& successor) {
   const BasicBlock* bb = successor.reference().basic_block();
@@ -49,6 +90,349 @@ const BasicCodeBlock* GetSuccessorBB(const Successor& successor) {
   return code_bb;
 }
 
+void BuildExtTspGraph(const BasicBlockOrdering& order,
+                      const SubGraphProfile& profile,
+                      ExtTspGraph* graph) {
+  DCHECK_NE(reinterpret_cast<ExtTspGraph*>(NULL), graph);
+
+  std::map<const BasicCodeBlock*, size_t> indices;
+  for (size_t i = 0; i < order.size(); ++i)
+    indices[order[i]] = i;
+
+  graph->sizes.resize(order.size());
+  graph->counts.resize(order.size());
+  graph->jumps.resize(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const BasicCodeBlock* bb = order[i];
+    const BasicBlockProfile* bb_profile = profile.GetBasicBlockProfile(bb);
+    const BasicCodeBlock::Successors& successors = bb->successors();
+
+    // Every basic block takes some room, so that jumps over it aren't free.
+    size_t size = bb->GetInstructionSize() +
+        kBranchSizeEstimate * successors.size();
+    graph->sizes[i] = std::max(size, static_cast<size_t>(1));
+    graph->counts[i] = bb_profile->count();
+
+    BasicCodeBlock::Successors::const_iterator succ = successors.begin();
+    for (; succ != successors.end(); ++succ) {
+      const BasicCodeBlock* succ_bb = GetSuccessorBB(*succ);
+      if (succ_bb == NULL)
+        continue;
+      std::map<const BasicCodeBlock*, size_t>::const_iterator index =
+          indices.find(succ_bb);
+      if (index == indices.end())
+        continue;
+      EntryCountType count = bb_profile->GetSuccessorCount(succ_bb);
+      if (count == 0)
+        continue;
+      ExtTspJump jump = { index->second, count };
+      graph->jumps[i].push_back(jump);
+    }
+  }
+}
+
+// @returns the Ext-TSP score of a jump.
+// @param source_end the address of the end of the source basic block.
+// @param target the address of the target basic block.
+// @param count the number of times the jump is taken.
+double GetExtTspJumpScore(size_t source_end,
+                          size_t target,
+                          EntryCountType count) {
+  if (target == source_end)
+    return kFallThroughWeight * count;
+
+  if (target > source_end) {
+    size_t distance = target - source_end;
+    if (distance >= kForwardDistance)
+      return 0.0;
+    return kForwardWeight * count *
+        (1.0 - static_cast<double>(distance) / kForwardDistance);
+  }
+
+  size_t distance = source_end - target;
+  if (distance >= kBackwardDistance)
+    return 0.0;
+  return kBackwardWeight * count *
+      (1.0 - static_cast<double>(distance) / kBackwardDistance);
+}
+
+// Merges chains of basic blocks, the most profitable merge first, until no
+// merge improves the Ext-TSP score of the layout.
+class ExtTspLayout {
+ public:
+  typedef std::vector<size_t> Chain;
+
+  explicit ExtTspLayout(const ExtTspGraph* graph);
+
+  // Computes the layout.
+  // @param order receives the indices of the basic blocks, in their new
+  //     order.
+  void Compute(Chain* order);
+
+  // @returns the score of the jumps between the basic blocks of a chain.
+  double Score(const Chain& chain);
+
+ private:
+  // The address of the basic blocks not in the chain being scored.
+  static const size_t kNotPlaced = static_cast<size_t>(-1);
+
+  // The best merge of two chains, if it has a positive gain.
+  struct Merge {
+    Merge() : gain(0.0) {}
+
+    double gain;
+    // This is empty if no merge has a positive gain.
+    Chain merged;
+  };
+  // Two chains, the lowest index first.
+  typedef std::pair<size_t, size_t> ChainPair;
+  typedef std::map<ChainPair, Merge> MergeMap;
+
+  // Finds the most profitable way of merging the chain @p y into the chain
+  // @p x, possibly splitting @p x.
+  // @param merged receives the merged chain if it's better than @p gain.
+  // @param gain the gain to beat, updated with that of @p merged.
+  // @returns true if a better merge was found.
+  bool FindMerge(size_t x, size_t y, Chain* merged, double* gain);
+
+  // Evaluates a candidate merge, keeping it if it's the best so far.
+  // @returns true if it's better than @p gain.
+  bool EvaluateMerge(const Chain& candidate,
+                     double base_score,
+                     Chain* merged,
+                     double* gain);
+
+  // @returns the execution count of the bytes of a chain, on average. This
+  //     orders the chains.
+  double Density(const Chain& chain) const;
+
+  const ExtTspGraph* graph_;
+  std::vector<Chain> chains_;
+  std::vector<double> scores_;
+  std::vector<size_t> chain_of_;
+  // Scratch space for Score, indexed by basic block.
+  std::vector<size_t> addresses_;
+  // The merges evaluated so far, by pair of chains.
+  MergeMap merges_;
+
+  DISALLOW_COPY_AND_ASSIGN(ExtTspLayout);
+};
+
+// Orders chains by decreasing density, then by their original position.
+class ChainDensityGreater {
+ public:
+  explicit ChainDensityGreater(const std::vector<double>* densities)
+      : densities_(densities) {
+  }
+
+  bool operator()(const ExtTspLayout::Chain* chain1,
+                  const ExtTspLayout::Chain* chain2) const {
+    double density1 = (*densities_)[chain1->front()];
+    double density2 = (*densities_)[chain2->front()];
+    if (density1 != density2)
+      return density1 > density2;
+    return chain1->front() < chain2->front();
+  }
+
+ private:
+  const std::vector<double>* densities_;
+};
+
+ExtTspLayout::ExtTspLayout(const ExtTspGraph* graph)
+    : graph_(graph),
+      chains_(graph->sizes.size()),
+      scores_(graph->sizes.size()),
+      chain_of_(graph->sizes.size()),
+      addresses_(graph->sizes.size(), kNotPlaced) {
+  DCHECK_NE(reinterpret_cast<const ExtTspGraph*>(NULL), graph);
+
+  // Each basic block starts in a chain of its own.
+  for (size_t i = 0; i < chains_.size(); ++i) {
+    chains_[i].push_back(i);
+    chain_of_[i] = i;
+    scores_[i] = Score(chains_[i]);
+  }
+}
+
+void ExtTspLayout::Compute(Chain* order) {
+  DCHECK_NE(reinterpret_cast<Chain*>(NULL), order);
+
+  while (true) {
+    // Find the best merge of two chains connected by a jump. The merges of
+    // the chains left untouched by the previous iteration are still valid.
+    Merge* best = NULL;
+    ChainPair best_pair;
+    for (size_t i = 0; i < graph_->jumps.size(); ++i) {
+      for (size_t j = 0; j < graph_->jumps[i].size(); ++j) {
+        size_t x = chain_of_[i];
+        size_t y = chain_of_[graph_->jumps[i][j].target];
+        if (x == y)
+          continue;
+
+        ChainPair pair(std::min(x, y), std::max(x, y));
+        std::pair<MergeMap::iterator, bool> result =
+            merges_.insert(std::make_pair(pair, Merge()));
+        Merge& merge = result.first->second;
+        if (result.second) {
+          // Try splitting either of the chains.
+          FindMerge(x, y, &merge.merged, &merge.gain);
+          FindMerge(y, x, &merge.merged, &merge.gain);
+        }
+
+        if (merge.merged.empty())
+          continue;
+        if (best == NULL || merge.gain > best->gain) {
+          best = &merge;
+          best_pair = pair;
+        }
+      }
+    }
+    if (best == NULL)
+      break;
+
+    // Commit the merge into the first of the chains, and forget the merges
+    // involving either of them.
+    size_t x = best_pair.first;
+    size_t y = best_pair.second;
+    chains_[x].swap(best->merged);
+    chains_[y].clear();
+    scores_[x] = Score(chains_[x]);
+    scores_[y] = 0.0;
+    for (size_t i = 0; i < chains_[x].size(); ++i)
+      chain_of_[chains_[x][i]] = x;
+
+    MergeMap::iterator it = merges_.begin();
+    while (it != merges_.end()) {
+      if (it->first.first == x || it->first.second == x ||
+          it->first.first == y || it->first.second == y) {
+        it = merges_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // The chain of the entry comes first, followed by the others from the
+  // densest to the coldest.
+  std::vector<double> densities(chains_.size(), 0.0);
+  std::vector<const Chain*> chains;
+  for (size_t i = 0; i < chains_.size(); ++i) {
+    if (chains_[i].empty())
+      continue;
+    densities[chains_[i].front()] = Density(chains_[i]);
+    if (chain_of_[0] != i)
+      chains.push_back(&chains_[i]);
+  }
+  std::sort(chains.begin(), chains.end(), ChainDensityGreater(&densities));
+  chains.insert(chains.begin(), &chains_[chain_of_[0]]);
+
+  order->clear();
+  for (size_t i = 0; i < chains.size(); ++i)
+    order->insert(order->end(), chains[i]->begin(), chains[i]->end());
+}
+
+double ExtTspLayout::Score(const Chain& chain) {
+  size_t address = 0;
+  for (size_t i = 0; i < chain.size(); ++i) {
+    addresses_[chain[i]] = address;
+    address += graph_->sizes[chain[i]];
+  }
+
+  double score = 0.0;
+  for (size_t i = 0; i < chain.size(); ++i) {
+    size_t source = chain[i];
+    size_t source_end = addresses_[source] + graph_->sizes[source];
+    const std::vector<ExtTspJump>& jumps = graph_->jumps[source];
+    for (size_t j = 0; j < jumps.size(); ++j) {
+      size_t target = addresses_[jumps[j].target];
+      if (target == kNotPlaced)
+        continue;
+      score += GetExtTspJumpScore(source_end, target, jumps[j].count);
+    }
+  }
+
+  for (size_t i = 0; i < chain.size(); ++i)
+    addresses_[chain[i]] = kNotPlaced;
+
+  return score;
+}
+
+bool ExtTspLayout::FindMerge(size_t x, size_t y, Chain* merged, double* gain) {
+  DCHECK_NE(reinterpret_cast<Chain*>(NULL), merged);
+  DCHECK_NE(reinterpret_cast<double*>(NULL), gain);
+
+  const Chain& chain_x = chains_[x];
+  const Chain& chain_y = chains_[y];
+  double base_score = scores_[x] + scores_[y];
+  bool found = false;
+
+  // Concatenate the chains, in either order.
+  Chain candidate(chain_x);
+  candidate.insert(candidate.end(), chain_y.begin(), chain_y.end());
+  found |= EvaluateMerge(candidate, base_score, merged, gain);
+  candidate.assign(chain_y.begin(), chain_y.end());
+  candidate.insert(candidate.end(), chain_x.begin(), chain_x.end());
+  found |= EvaluateMerge(candidate, base_score, merged, gain);
+
+  if (chain_x.size() > kChainSplitThreshold)
+    return found;
+
+  // Split x into x1 and x2, and try x1-y-x2, y-x2-x1 and x2-x1-y.
+  for (size_t split = 1; split < chain_x.size(); ++split) {
+    Chain::const_iterator middle = chain_x.begin() + split;
+
+    candidate.assign(chain_x.begin(), middle);
+    candidate.insert(candidate.end(), chain_y.begin(), chain_y.end());
+    candidate.insert(candidate.end(), middle, chain_x.end());
+    found |= EvaluateMerge(candidate, base_score, merged, gain);
+
+    candidate.assign(chain_y.begin(), chain_y.end());
+    candidate.insert(candidate.end(), middle, chain_x.end());
+    candidate.insert(candidate.end(), chain_x.begin(), middle);
+    found |= EvaluateMerge(candidate, base_score, merged, gain);
+
+    candidate.assign(middle, chain_x.end());
+    candidate.insert(candidate.end(), chain_x.begin(), middle);
+    candidate.insert(candidate.end(), chain_y.begin(), chain_y.end());
+    found |= EvaluateMerge(candidate, base_score, merged, gain);
+  }
+
+  return found;
+}
+
+bool ExtTspLayout::EvaluateMerge(const Chain& candidate,
+                                 double base_score,
+                                 Chain* merged,
+                                 double* gain) {
+  DCHECK(!candidate.empty());
+
+  // The entry of the function can't move.
+  if (candidate.front() != 0 &&
+      std::find(candidate.begin(), candidate.end(), 0) != candidate.end()) {
+    return false;
+  }
+
+  // Insist on a strict improvement, to avoid churning on ties.
+  double candidate_gain = Score(candidate) - base_score;
+  if (candidate_gain <= *gain + 1e-9)
+    return false;
+
+  *merged = candidate;
+  *gain = candidate_gain;
+  return true;
+}
+
+double ExtTspLayout::Density(const Chain& chain) const {
+  double count = 0.0;
+  size_t size = 0;
+  for (size_t i = 0; i < chain.size(); ++i) {
+    count += static_cast<double>(graph_->counts[chain[i]]) *
+        graph_->sizes[chain[i]];
+    size += graph_->sizes[chain[i]];
+  }
+  return count / size;
+}
+
 void FlattenStructuralTreeRecursive(const StructuralNode* tree,
                                     const SubGraphProfile* profile,
                                     BasicBlockOrdering* order,
@@ -166,6 +550,47 @@ uint64_t BasicBlockReorderingTransform::EvaluateCost(
   return accumulate;
 }
 
+bool BasicBlockReorderingTransform::ComputeExtTspOrder(
+    const BasicBlockOrdering& original_order,
+    const SubGraphProfile& profile,
+    BasicBlockOrdering* order) {
+  DCHECK_NE(reinterpret_cast<BasicBlockOrdering*>(NULL), order);
+
+  if (original_order.size() > kMaxExtTspBasicBlockCount)
+    return false;
+
+  ExtTspGraph graph;
+  BuildExtTspGraph(original_order, profile, &graph);
+
+  ExtTspLayout::Chain indices;
+  if (!original_order.empty()) {
+    ExtTspLayout layout(&graph);
+    layout.Compute(&indices);
+  }
+
+  order->clear();
+  for (size_t i = 0; i < indices.size(); ++i)
+    order->push_back(original_order[indices[i]]);
+
+  return true;
+}
+
+double BasicBlockReorderingTransform::EvaluateExtTspScore(
+    const BasicBlockOrdering& order,
+    const SubGraphProfile& profile) {
+  if (order.empty())
+    return 0.0;
+
+  ExtTspGraph graph;
+  BuildExtTspGraph(order, profile, &graph);
+
+  ExtTspLayout::Chain indices;
+  for (size_t i = 0; i < order.size(); ++i)
+    indices.push_back(i);
+  ExtTspLayout layout(&graph);
+  return layout.Score(indices);
+}
+
 void BasicBlockReorderingTransform::CommitOrdering(
     const BasicBlockOrdering& order,
     BasicEndBlock* basic_end_block,
@@ -264,6 +689,21 @@ bool BasicBlockReorderingTransform::TransformBasicBlockSubGraph(
   if (original_cost == 0)
     return true;
 
+  if (layout_ == kExtTspLayout) {
+    BasicBlockOrdering ext_tsp_order;
+    if (!ComputeExtTspOrder(original_order, *subgraph_profile,
+                            &ext_tsp_order)) {
+      return true;
+    }
+
+    // If the new basic block layout has a better score, commit it.
+    if (EvaluateExtTspScore(ext_tsp_order, *subgraph_profile) >
+        EvaluateExtTspScore(original_order, *subgraph_profile)) {
+      CommitOrdering(ext_tsp_order, end_block, &original_order_list);
+    }
+    return true;
+  }
+
   BasicBlockOrdering flatten_order;
   bool reducible = FlattenStructuralTreeToAnOrder(subgraph,
                                                   subgraph_profile,
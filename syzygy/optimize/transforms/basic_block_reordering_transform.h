@@ -20,6 +20,13 @@
 // see: K.Pettis, R.C.Hansen, Profile Guided Code Positioning,
 //     Proceedings of the ACM SIGPLAN 1990 Conference on Programming Language
 //     Design and Implementation, Vol. 25, No. 6, June 1990, pp. 16-27.
+//
+// It can instead merge chains of basic blocks to maximize the Ext-TSP score of
+// the layout, which rewards fall-throughs and, to a lesser extent, short jumps.
+//
+// see: A.Newell, S.Pupyrev, Improved Basic Block Reordering, IEEE
+//     Transactions on Computers, Vol. 69, No. 12, December 2020,
+//     pp. 1784-1794.
 
 #ifndef SYZYGY_OPTIMIZE_TRANSFORMS_BASIC_BLOCK_REORDERING_TRANSFORM_H_
 #define SYZYGY_OPTIMIZE_TRANSFORMS_BASIC_BLOCK_REORDERING_TRANSFORM_H_
@@ -42,8 +49,24 @@ class BasicBlockReorderingTransform : public SubGraphTransformInterface {
   typedef block_graph::analysis::ControlFlowAnalysis::BasicBlockOrdering
       BasicBlockOrdering;
 
+  // The algorithms deriving the order of the basic blocks of a function.
+  enum Layout {
+    // Flattens the structural tree of the function, and keeps the order if it
+    // takes fewer jumps.
+    kStructuralLayout,
+    // Merges chains of basic blocks, and keeps the order if it has a better
+    // Ext-TSP score.
+    kExtTspLayout,
+  };
+
   // Constructor.
-  BasicBlockReorderingTransform() { }
+  BasicBlockReorderingTransform() : layout_(kStructuralLayout) { }
+
+  // @name Accessors.
+  // @{
+  Layout layout() const { return layout_; }
+  void set_layout(Layout layout) { layout_ = layout; }
+  // @}
 
   // @name SubGraphTransformInterface implementation.
   // @{
@@ -70,9 +93,26 @@ class BasicBlockReorderingTransform : public SubGraphTransformInterface {
       const BasicBlockOrdering& order,
       block_graph::BasicEndBlock* basic_end_block,
       BasicBlockSubGraph::BasicBlockOrdering* target);
+
+  // Computes an order of basic blocks with the Ext-TSP chain merging
+  // algorithm. The first basic block stays first.
+  // @param original_order the basic blocks to order, entry first.
+  // @param profile the profile of the basic blocks.
+  // @param order receives the new order.
+  // @returns true on success, false if the function is too large for the
+  //     algorithm.
+  static bool ComputeExtTspOrder(const BasicBlockOrdering& original_order,
+                                 const SubGraphProfile& profile,
+                                 BasicBlockOrdering* order);
+
+  // @returns the Ext-TSP score of an order of basic blocks. Higher is better.
+  static double EvaluateExtTspScore(const BasicBlockOrdering& order,
+                                    const SubGraphProfile& profile);
   // @}
 
  private:
+  Layout layout_;
+
   DISALLOW_COPY_AND_ASSIGN(BasicBlockReorderingTransform);
 };
 
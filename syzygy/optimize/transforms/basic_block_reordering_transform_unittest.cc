@@ -94,6 +94,8 @@ class TestBasicBlockReorderingTransform : public BasicBlockReorderingTransform {
  public:
   using BasicBlockReorderingTransform::EvaluateCost;
   using BasicBlockReorderingTransform::CommitOrdering;
+  using BasicBlockReorderingTransform::ComputeExtTspOrder;
+  using BasicBlockReorderingTransform::EvaluateExtTspScore;
   using BasicBlockReorderingTransform::FlattenStructuralTreeToAnOrder;
 };
 
@@ -394,6 +396,57 @@ TEST_F(BasicBlockReorderingTransformTest, FlattenStructuralTreeToAnOrder) {
   EXPECT_THAT(order, ElementsAre(b1_, b2_, b3_, b4_, b5_));
 }
 
+TEST_F(BasicBlockReorderingTransformTest, EvaluateExtTspScore) {
+  BasicBlockOrdering bad_order;
+  bad_order.push_back(b1_);
+  bad_order.push_back(b5_);
+  bad_order.push_back(b4_);
+  bad_order.push_back(b3_);
+  bad_order.push_back(b2_);
+
+  BasicBlockOrdering sequential_order;
+  sequential_order.push_back(b1_);
+  sequential_order.push_back(b2_);
+  sequential_order.push_back(b3_);
+  sequential_order.push_back(b4_);
+  sequential_order.push_back(b5_);
+
+  BasicBlockOrdering unlikely_order;
+  unlikely_order.push_back(b1_);
+  unlikely_order.push_back(b3_);
+  unlikely_order.push_back(b4_);
+  unlikely_order.push_back(b5_);
+  unlikely_order.push_back(b2_);
+
+  // The more jumps fall through, the better the score.
+  double bad_score = TestBasicBlockReorderingTransform::EvaluateExtTspScore(
+      bad_order, subgraph_profile_);
+  double sequential_score =
+      TestBasicBlockReorderingTransform::EvaluateExtTspScore(
+          sequential_order, subgraph_profile_);
+  double unlikely_score =
+      TestBasicBlockReorderingTransform::EvaluateExtTspScore(
+          unlikely_order, subgraph_profile_);
+  EXPECT_LT(bad_score, sequential_score);
+  EXPECT_LT(sequential_score, unlikely_score);
+}
+
+TEST_F(BasicBlockReorderingTransformTest, ComputeExtTspOrder) {
+  BasicBlockOrdering original_order;
+  original_order.push_back(b1_);
+  original_order.push_back(b5_);
+  original_order.push_back(b4_);
+  original_order.push_back(b3_);
+  original_order.push_back(b2_);
+
+  // The hot path falls through, the entry stays first and the least likely
+  // branch moves to the end.
+  BasicBlockOrdering order;
+  ASSERT_TRUE(TestBasicBlockReorderingTransform::ComputeExtTspOrder(
+      original_order, subgraph_profile_, &order));
+  EXPECT_THAT(order, ElementsAre(b1_, b3_, b4_, b5_, b2_));
+}
+
 TEST_F(BasicBlockReorderingTransformTest, ApplyTransformWithoutProfile) {
   BlockGraph::Block* block =
       block_graph_.AddBlock(BlockGraph::CODE_BLOCK, sizeof(kCodeJump), "jump");
@@ -447,5 +500,34 @@ TEST_F(BasicBlockReorderingTransformTest, ApplyTransformWithProfileAndGain) {
   EXPECT_THAT(kCodeJump, ElementsAreArray(block->data(), block->size()));
 }
 
+TEST_F(BasicBlockReorderingTransformTest,
+       ApplyTransformWithExtTspLayoutAndGain) {
+  tx_.set_layout(BasicBlockReorderingTransform::kExtTspLayout);
+  EXPECT_EQ(BasicBlockReorderingTransform::kExtTspLayout, tx_.layout());
+
+  BlockGraph::Block* block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK,
+                            sizeof(kCodeJumpInv),
+                            "jump");
+  DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), block);
+  block->SetData(kCodeJumpInv, sizeof(kCodeJumpInv));
+
+  // Insert the block profile into the profile map.
+  ApplicationProfile::BlockProfile block_profile(kRunMoreThanOnce, kHot);
+  profile_.profiles_.insert(std::make_pair(block->id(), block_profile));
+
+  TestBasicBlockProfile bb_profiles[] = {
+    TestBasicBlockProfile(kRunMoreThanOnce, kHot, kRunMoreThanOnce),
+    TestBasicBlockProfile(kRunMoreThanOnce, kHot, kRunMoreThanOnce),
+    TestBasicBlockProfile(kRunMoreThanOnce, kHot, kRunMoreThanOnce)
+  };
+
+  ASSERT_NO_FATAL_FAILURE(
+      ApplyTransform(&block, bb_profiles, arraysize(bb_profiles)));
+
+  // Both hot jumps now fall through.
+  EXPECT_THAT(kCodeJump, ElementsAreArray(block->data(), block->size()));
+}
+
 }  // namespace transforms
 }  // namespace optimize
@@ -14,14 +14,113 @@
 
 #include "syzygy/optimize/transforms/block_alignment_transform.h"
 
+#include <map>
+#include <set>
+
 #include "syzygy/block_graph/block_graph.h"
 
 namespace optimize {
 namespace transforms {
 
 namespace {
+
 using block_graph::BasicBlock;
+using block_graph::BasicBlockSubGraph;
 using block_graph::BasicCodeBlock;
+using block_graph::Successor;
+typedef ApplicationProfile::BlockProfile BlockProfile;
+typedef BasicBlockSubGraph::BasicBlockOrdering BasicBlockOrdering;
+typedef SubGraphProfile::BasicBlockProfile BasicBlockProfile;
+typedef grinder::basic_block_util::EntryCountType EntryCountType;
+
+// The alignment of functions that are not hot. This is the alignment that
+// has always been applied to every function.
+const size_t kFunctionAlignment = 32;
+
+// The alignment of hot functions, so that their entry doesn't straddle cache
+// lines.
+const size_t kHotFunctionAlignment = 64;
+
+// The alignment of hot loop heads. This is deliberately less than a cache
+// line, as the padding in front of a loop head is made of NOPs that are run
+// whenever the loop is entered by falling through. 16 bytes keeps the loop
+// head at the start of an instruction fetch block.
+const size_t kLoopHeadAlignment = 16;
+
+// @returns true if @p block_profile describes a hot function.
+bool IsHot(const BlockProfile* block_profile) {
+  DCHECK_NE(reinterpret_cast<const BlockProfile*>(NULL), block_profile);
+  return block_profile->count() != 0 &&
+      block_profile->percentile() < ApplicationProfile::kHotPercentile;
+}
+
+// @returns the basic block targeted by @p successor, or NULL if it targets
+//     another block.
+const BasicCodeBlock* GetSuccessorBB(const Successor& successor) {
+  const BasicBlock* bb = successor.reference().basic_block();
+  if (bb == NULL)
+    return NULL;
+  return BasicCodeBlock::Cast(bb);
+}
+
+// Aligns the heads of the loops of @p order that are mostly entered through
+// their back edge. A back edge is a branch to a basic block that is laid out
+// at or before the branch.
+void AlignLoopHeads(const SubGraphProfile* subgraph_profile,
+                    BasicBlockOrdering* order) {
+  DCHECK_NE(reinterpret_cast<const SubGraphProfile*>(NULL), subgraph_profile);
+  DCHECK_NE(reinterpret_cast<BasicBlockOrdering*>(NULL), order);
+
+  std::map<const BasicBlock*, size_t> positions;
+  BasicBlockOrdering::iterator it = order->begin();
+  for (size_t i = 0; it != order->end(); ++it, ++i)
+    positions[*it] = i;
+
+  // Find the loop heads first, as the successors only give access to const
+  // basic blocks.
+  std::set<const BasicBlock*> loop_heads;
+  it = order->begin();
+  for (size_t i = 0; it != order->end(); ++it, ++i) {
+    const BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+    if (bb == NULL)
+      continue;
+
+    const BasicBlockProfile* bb_profile =
+        subgraph_profile->GetBasicBlockProfile(bb);
+    const BasicCodeBlock::Successors& successors = bb->successors();
+    BasicCodeBlock::Successors::const_iterator succ = successors.begin();
+    for (; succ != successors.end(); ++succ) {
+      const BasicCodeBlock* head = GetSuccessorBB(*succ);
+      if (head == NULL)
+        continue;
+
+      // The function entry is aligned with the block.
+      std::map<const BasicBlock*, size_t>::const_iterator head_position =
+          positions.find(head);
+      if (head_position == positions.end() || head_position->second == 0 ||
+          head_position->second > i) {
+        continue;
+      }
+
+      // Only align loops that iterate, as otherwise the NOPs in front of the
+      // head cost more than they save.
+      EntryCountType back_edge_count = bb_profile->GetSuccessorCount(head);
+      EntryCountType head_count =
+          subgraph_profile->GetBasicBlockProfile(head)->count();
+      if (back_edge_count == 0 || 2 * back_edge_count < head_count)
+        continue;
+
+      loop_heads.insert(head);
+    }
+  }
+
+  for (it = order->begin(); it != order->end(); ++it) {
+    BasicBlock* bb = *it;
+    if (loop_heads.count(bb) != 0 && bb->alignment() < kLoopHeadAlignment)
+      bb->set_alignment(kLoopHeadAlignment);
+  }
+}
+
 }  // namespace
 
 bool BlockAlignmentTransform::TransformBasicBlockSubGraph(
@@ -36,25 +135,26 @@ bool BlockAlignmentTransform::TransformBasicBlockSubGraph(
   DCHECK_NE(reinterpret_cast<ApplicationProfile*>(NULL), profile);
   DCHECK_NE(reinterpret_cast<SubGraphProfile*>(NULL), subgraph_profile);
 
-  // Iterates through each basic block.
-  BasicBlockSubGraph::BBCollection::iterator bb_iter =
-      subgraph->basic_blocks().begin();
-  for (; bb_iter != subgraph->basic_blocks().end(); ++bb_iter) {
-    BasicCodeBlock* bb = BasicCodeBlock::Cast(*bb_iter);
-    if (bb == NULL)
-      continue;
-    // TODO(etienneb): Basic block alignment based on frequencies (PGO).
-  }
+  if (subgraph->block_descriptions().empty())
+    return true;
+
+  BasicBlockSubGraph::BlockDescription& description =
+      subgraph->block_descriptions().front();
+  bool is_hot = subgraph->original_block() != NULL &&
+      IsHot(profile->GetBlockProfile(subgraph->original_block()));
 
-  // Apply function alignment.
-  if (!subgraph->block_descriptions().empty()) {
-    BasicBlockSubGraph::BlockDescription& description =
-        subgraph->block_descriptions().front();
-    // TODO(etienneb): Function alignment based on frequencies (PGO).
-    if (description.alignment <= 1)
-      description.alignment = 32;
+  // Apply function alignment. Hot functions start on a cache line.
+  size_t alignment = is_hot ? kHotFunctionAlignment : kFunctionAlignment;
+  if (description.alignment <= 1 ||
+      (is_hot && description.alignment < alignment)) {
+    description.alignment = alignment;
   }
 
+  // Apply basic block alignment to the loops of hot functions. Cold code is
+  // left alone as the padding would only make it bigger.
+  if (is_hot)
+    AlignLoopHeads(subgraph_profile, &description.basic_block_order);
+
   return true;
 }
 
@@ -12,7 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
-// This class implements the functions alignment transformation.
+// This class implements the functions alignment transformation. Functions are
+// aligned to 32 bytes, and hot functions to a cache line. The heads of the
+// loops of hot functions that iterate are aligned as well.
 
 #ifndef SYZYGY_OPTIMIZE_TRANSFORMS_BLOCK_ALIGNMENT_TRANSFORM_H_
 #define SYZYGY_OPTIMIZE_TRANSFORMS_BLOCK_ALIGNMENT_TRANSFORM_H_
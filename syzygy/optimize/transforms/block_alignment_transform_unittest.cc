@@ -26,7 +26,9 @@ namespace transforms {
 
 namespace {
 
+using block_graph::BasicBlock;
 using block_graph::BasicBlockDecomposer;
+using block_graph::BasicCodeBlock;
 using block_graph::BlockBuilder;
 using block_graph::BlockGraph;
 using block_graph::BasicBlockSubGraph;
@@ -34,14 +36,44 @@ using optimize::ApplicationProfile;
 using optimize::SubGraphProfile;
 using pe::ImageLayout;
 
+typedef grinder::basic_block_util::EntryCountType EntryCountType;
+
 // Dummy code body.
 const uint8_t kCodeBody1[] = {0x74, 0x02, 0x33, 0xC0, 0xC3};
 const uint8_t kCodeBody2[] = {0x0B, 0xC0, 0x75, 0xFC, 0xC3};
 
+// _asm xor eax, eax
+// loop:
+// _asm inc eax
+// _asm jne loop
+// _asm ret
+const uint8_t kCodeLoop[] = {0x33, 0xC0, 0x40, 0x75, 0xFD, 0xC3};
+
+class TestApplicationProfile : public ApplicationProfile {
+ public:
+  explicit TestApplicationProfile(const ImageLayout* image_layout)
+      : ApplicationProfile(image_layout) {
+  }
+
+  using ApplicationProfile::profiles_;
+};
+
+class TestSubGraphProfile : public SubGraphProfile {
+ public:
+  using SubGraphProfile::basic_blocks_;
+};
+
+class TestBasicBlockProfile : public SubGraphProfile::BasicBlockProfile {
+ public:
+  using SubGraphProfile::BasicBlockProfile::count_;
+  using SubGraphProfile::BasicBlockProfile::successors_;
+};
+
 class BlockAlignmentTransformTest : public testing::Test {
  public:
   BlockAlignmentTransformTest()
-      : code1_(NULL), code2_(NULL), image_(&block_graph_), profile_(&image_) {
+      : code1_(NULL), code2_(NULL), image_(&block_graph_), profile_(&image_),
+        loop_(NULL) {
   }
 
   virtual void SetUp() {
@@ -56,10 +88,31 @@ class BlockAlignmentTransformTest : public testing::Test {
                                    "code2");
     DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), code2_);
     code2_->SetData(kCodeBody2, code2_->size());
+
+    loop_ = block_graph_.AddBlock(BlockGraph::CODE_BLOCK,
+                                  sizeof(kCodeLoop),
+                                  "loop");
+    DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), loop_);
+    loop_->SetData(kCodeLoop, loop_->size());
   }
 
   void ApplyTransform(BlockGraph::Block** block);
 
+  // Makes @p block one of the hottest functions.
+  void MakeHot(const BlockGraph::Block* block) {
+    ApplicationProfile::BlockProfile block_profile(100, 1000);
+    block_profile.set_percentile(0.0);
+    profile_.profiles_[block->id()] = block_profile;
+  }
+
+  // Decomposes a block holding a loop into @p subgraph.
+  // @param loop_count the number of times the loop iterates, each time it is
+  //     entered.
+  // @param head receives the head of the loop.
+  void DecomposeLoop(EntryCountType loop_count,
+                     BasicBlockSubGraph* subgraph,
+                     BasicBlock** head);
+
  protected:
   pe::PETransformPolicy policy_;
   BlockGraph block_graph_;
@@ -67,8 +120,9 @@ class BlockAlignmentTransformTest : public testing::Test {
   BlockGraph::Block* code2_;
   BlockAlignmentTransform tx_;
   ImageLayout image_;
-  ApplicationProfile profile_;
-  SubGraphProfile subgraph_profile_;
+  TestApplicationProfile profile_;
+  TestSubGraphProfile subgraph_profile_;
+  BlockGraph::Block* loop_;
 };
 
 void BlockAlignmentTransformTest::ApplyTransform(BlockGraph::Block** block) {
@@ -89,6 +143,31 @@ void BlockAlignmentTransformTest::ApplyTransform(BlockGraph::Block** block) {
   *block = *builder.new_blocks().begin();
 }
 
+void BlockAlignmentTransformTest::DecomposeLoop(EntryCountType loop_count,
+                                                BasicBlockSubGraph* subgraph,
+                                                BasicBlock** head) {
+  BasicBlockDecomposer decomposer(loop_, subgraph);
+  ASSERT_TRUE(decomposer.Decompose());
+  ASSERT_EQ(1u, subgraph->block_descriptions().size());
+
+  // The loop head is the second basic block, and branches back to itself.
+  BasicBlockSubGraph::BasicBlockOrdering& order =
+      subgraph->block_descriptions().front().basic_block_order;
+  ASSERT_LE(2u, order.size());
+  BasicBlockSubGraph::BasicBlockOrdering::iterator it = order.begin();
+  ++it;
+  *head = *it;
+  BasicCodeBlock* head_bb = BasicCodeBlock::Cast(*head);
+  ASSERT_NE(reinterpret_cast<BasicCodeBlock*>(NULL), head_bb);
+
+  // The head is entered once from the function entry, then through its back
+  // edge.
+  TestBasicBlockProfile head_profile;
+  head_profile.count_ = loop_count + 1;
+  head_profile.successors_[head_bb] = loop_count;
+  subgraph_profile_.basic_blocks_[head_bb] = head_profile;
+}
+
 }  // namespace
 
 TEST_F(BlockAlignmentTransformTest, AlignmentTest) {
@@ -103,5 +182,54 @@ TEST_F(BlockAlignmentTransformTest, AlignmentTest) {
   EXPECT_EQ(2U, code2_->alignment());
 }
 
+TEST_F(BlockAlignmentTransformTest, HotFunctionsAreCacheLineAligned) {
+  MakeHot(code1_);
+  ApplyTransform(&code1_);
+  EXPECT_EQ(64U, code1_->alignment());
+
+  // A larger alignment is preserved.
+  code2_->set_alignment(128);
+  MakeHot(code2_);
+  ApplyTransform(&code2_);
+  EXPECT_EQ(128U, code2_->alignment());
+}
+
+TEST_F(BlockAlignmentTransformTest, HotLoopHeadsAreAligned) {
+  MakeHot(loop_);
+  BasicBlockSubGraph subgraph;
+  BasicBlock* head = NULL;
+  ASSERT_NO_FATAL_FAILURE(DecomposeLoop(10, &subgraph, &head));
+
+  ASSERT_TRUE(
+      tx_.TransformBasicBlockSubGraph(&policy_, &block_graph_, &subgraph,
+                                      &profile_, &subgraph_profile_));
+  EXPECT_EQ(16U, head->alignment());
+  EXPECT_EQ(64U, subgraph.block_descriptions().front().alignment);
+}
+
+TEST_F(BlockAlignmentTransformTest, ColdLoopHeadsAreNotAligned) {
+  BasicBlockSubGraph subgraph;
+  BasicBlock* head = NULL;
+  ASSERT_NO_FATAL_FAILURE(DecomposeLoop(10, &subgraph, &head));
+
+  ASSERT_TRUE(
+      tx_.TransformBasicBlockSubGraph(&policy_, &block_graph_, &subgraph,
+                                      &profile_, &subgraph_profile_));
+  EXPECT_EQ(1U, head->alignment());
+  EXPECT_EQ(32U, subgraph.block_descriptions().front().alignment);
+}
+
+TEST_F(BlockAlignmentTransformTest, LoopsThatDontIterateAreNotAligned) {
+  MakeHot(loop_);
+  BasicBlockSubGraph subgraph;
+  BasicBlock* head = NULL;
+  ASSERT_NO_FATAL_FAILURE(DecomposeLoop(0, &subgraph, &head));
+
+  ASSERT_TRUE(
+      tx_.TransformBasicBlockSubGraph(&policy_, &block_graph_, &subgraph,
+                                      &profile_, &subgraph_profile_));
+  EXPECT_EQ(1U, head->alignment());
+}
+
 }  // namespace transforms
 }  // namespace optimize
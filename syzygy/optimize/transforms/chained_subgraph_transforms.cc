@@ -30,11 +30,28 @@ namespace {
 
 using block_graph::BasicBlockDecomposer;
 using block_graph::BasicBlockSubGraph;
+using block_graph::BasicCodeBlock;
 using block_graph::BlockBuilder;
 using block_graph::BlockGraph;
 using block_graph::BlockVector;
 typedef BlockGraph::Block::ReferrerSet ReferrerSet;
 typedef std::list<BlockGraph::Block*> BlockOrdering;
+typedef BasicBlockSubGraph::BlockDescription BlockDescription;
+typedef BasicBlockSubGraph::BlockDescriptionList BlockDescriptionList;
+
+// @returns the sum of the entry counts of the basic blocks of @p description.
+double GetTemperature(const BlockDescription& description,
+                      const SubGraphProfile& subgraph_profile) {
+  double temperature = 0;
+  BasicBlockSubGraph::BasicBlockOrdering::const_iterator it =
+      description.basic_block_order.begin();
+  for (; it != description.basic_block_order.end(); ++it) {
+    const BasicCodeBlock* bb = BasicCodeBlock::Cast(*it);
+    if (bb != NULL)
+      temperature += subgraph_profile.GetBasicBlockProfile(bb)->count();
+  }
+  return temperature;
+}
 
 // Traverse the call-graph in reverse call order (callee to caller) and push
 // blocks in post-order. The resulting ordering can be iterated to visit all
@@ -133,6 +150,9 @@ bool ChainedSubgraphTransforms::TransformBlockGraph(
     if (!policy->BlockIsSafeToBasicBlockDecompose(block))
       continue;
 
+    // Remember the ID of the block, as it is replaced by the merge below.
+    BlockGraph::BlockId original_id = block->id();
+
     // Decompose block to basic blocks.
     BasicBlockSubGraph subgraph;
     BasicBlockDecomposer bb_decomposer(block, &subgraph);
@@ -163,10 +183,30 @@ bool ChainedSubgraphTransforms::TransformBlockGraph(
       return false;
 
     // TODO(etienneb): This is needed until the labels refactoring.
+    // The first new block inherits the profile of the original block so that
+    // the orderers see the transformed code as being as hot as it was. The
+    // blocks holding parts split off it are profiled by their own basic
+    // blocks. The builder skips the empty descriptions.
     const BlockVector& blocks = builder.new_blocks();
     BlockVector::const_iterator new_block = blocks.begin();
-    for (; new_block != blocks.end(); ++new_block)
+    const BlockDescriptionList& descriptions = subgraph.block_descriptions();
+    BlockDescriptionList::const_iterator description = descriptions.begin();
+    for (; new_block != blocks.end(); ++new_block, ++description) {
+      while (description != descriptions.end() &&
+             description->basic_block_order.empty()) {
+        ++description;
+      }
+      DCHECK(description != descriptions.end());
+
       (*new_block)->set_attribute(BlockGraph::BUILT_BY_SYZYGY);
+      if (new_block == blocks.begin()) {
+        profile_->CopyBlockProfile(original_id, *new_block);
+      } else {
+        profile_->SplitBlockProfile(
+            original_id, *new_block,
+            GetTemperature(*description, *subgraph_profile));
+      }
+    }
   }
 
   return true;
@@ -0,0 +1,180 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/optimize/transforms/function_splitting_transform.h"
+
+#include <vector>
+
+#include "syzygy/block_graph/basic_block.h"
+#include "syzygy/pe/pe_utils.h"
+
+namespace optimize {
+namespace transforms {
+
+namespace {
+
+using block_graph::BasicBlock;
+using block_graph::BasicCodeBlock;
+using block_graph::BasicBlockSubGraph;
+using block_graph::BlockGraph;
+typedef BasicBlockSubGraph::BasicBlockOrdering BasicBlockOrdering;
+typedef BasicBlockSubGraph::BlockDescription BlockDescription;
+typedef ApplicationProfile::BlockProfile BlockProfile;
+typedef grinder::basic_block_util::EntryCountType EntryCountType;
+
+// The parts of a split function.
+enum FunctionPart {
+  kHotPart,
+  kWarmPart,
+  kColdPart,
+  kFunctionPartCount,
+};
+
+// The suffixes of the names of the blocks holding the parts.
+const char* kPartSuffixes[kFunctionPartCount] = { "", ".warm", ".cold" };
+
+// @param entry_count the entry count of the function.
+// @param is_hot true if the function is hot.
+// @param count the entry count of one of its basic blocks, but the entry.
+// @returns the part of the function the basic block belongs to.
+FunctionPart GetFunctionPart(EntryCountType entry_count,
+                             bool is_hot,
+                             EntryCountType count) {
+  if (count == 0)
+    return kColdPart;
+  if (is_hot &&
+      count < entry_count * FunctionSplittingTransform::kWarmRatio) {
+    return kWarmPart;
+  }
+  return kHotPart;
+}
+
+// Adds the description of a part split off a function.
+void AddPartDescription(FunctionPart part,
+                        BlockGraph::SectionId section,
+                        BasicBlockOrdering* order,
+                        BasicBlockSubGraph* subgraph) {
+  DCHECK_NE(reinterpret_cast<BasicBlockOrdering*>(NULL), order);
+  DCHECK_NE(reinterpret_cast<BasicBlockSubGraph*>(NULL), subgraph);
+
+  const BlockGraph::Block* block = subgraph->original_block();
+  BlockDescription* description = subgraph->AddBlockDescription(
+      block->name() + kPartSuffixes[part],
+      block->compiland_name(),
+      BlockGraph::CODE_BLOCK,
+      section,
+      block->alignment(),
+      block->attributes());
+  DCHECK_NE(reinterpret_cast<BlockDescription*>(NULL), description);
+  description->basic_block_order.swap(*order);
+}
+
+}  // namespace
+
+const char FunctionSplittingTransform::kDefaultColdSectionName[] = ".ctext";
+const double FunctionSplittingTransform::kWarmRatio = 0.05;
+const size_t FunctionSplittingTransform::kMinPartSize = 16;
+
+FunctionSplittingTransform::FunctionSplittingTransform()
+    : cold_section_name_(kDefaultColdSectionName) {
+}
+
+bool FunctionSplittingTransform::TransformBasicBlockSubGraph(
+    const TransformPolicyInterface* policy,
+    BlockGraph* block_graph,
+    BasicBlockSubGraph* subgraph,
+    ApplicationProfile* profile,
+    SubGraphProfile* subgraph_profile) {
+  DCHECK_NE(reinterpret_cast<TransformPolicyInterface*>(NULL), policy);
+  DCHECK_NE(reinterpret_cast<BlockGraph*>(NULL), block_graph);
+  DCHECK_NE(reinterpret_cast<BasicBlockSubGraph*>(NULL), subgraph);
+  DCHECK_NE(reinterpret_cast<ApplicationProfile*>(NULL), profile);
+  DCHECK_NE(reinterpret_cast<SubGraphProfile*>(NULL), subgraph_profile);
+
+  // Functions that never ran are moved whole by the orderer.
+  const BlockGraph::Block* block = subgraph->original_block();
+  DCHECK_NE(reinterpret_cast<const BlockGraph::Block*>(NULL), block);
+  const BlockProfile* block_profile = profile->GetBlockProfile(block);
+  if (block_profile->count() == 0)
+    return true;
+  bool is_hot =
+      block_profile->percentile() < ApplicationProfile::kHotPercentile;
+
+  // Only split functions made of a single block of code.
+  BasicBlockSubGraph::BlockDescriptionList& descriptions =
+      subgraph->block_descriptions();
+  if (descriptions.size() != 1)
+    return true;
+  BasicBlockOrdering& order = descriptions.front().basic_block_order;
+  BasicBlockOrdering::iterator it = order.begin();
+  for (; it != order.end(); ++it) {
+    if ((*it)->type() == BasicBlock::BASIC_DATA_BLOCK)
+      return true;
+  }
+
+  // Assign the basic blocks to the parts. The entry and the end block stay in
+  // the hot part.
+  std::vector<FunctionPart> assignment;
+  size_t part_sizes[kFunctionPartCount] = { 0, 0, 0 };
+  for (it = order.begin(); it != order.end(); ++it) {
+    FunctionPart part = kHotPart;
+    const BasicCodeBlock* code_bb = BasicCodeBlock::Cast(*it);
+    if (code_bb != NULL && it != order.begin()) {
+      part = GetFunctionPart(
+          block_profile->count(), is_hot,
+          subgraph_profile->GetBasicBlockProfile(code_bb)->count());
+      part_sizes[part] += code_bb->GetInstructionSize();
+    }
+    assignment.push_back(part);
+  }
+
+  // Parts too small to be worth the jump to them stay in the hot part.
+  bool split[kFunctionPartCount] = { false, false, false };
+  for (size_t i = kWarmPart; i < kFunctionPartCount; ++i)
+    split[i] = part_sizes[i] >= kMinPartSize;
+  if (!split[kWarmPart] && !split[kColdPart])
+    return true;
+
+  // Move the basic blocks of the split parts, keeping their relative order.
+  BasicBlockOrdering parts[kFunctionPartCount];
+  std::vector<FunctionPart>::const_iterator part = assignment.begin();
+  for (it = order.begin(); it != order.end(); ++it, ++part) {
+    if (split[*part])
+      parts[*part].push_back(*it);
+    else
+      parts[kHotPart].push_back(*it);
+  }
+  order.swap(parts[kHotPart]);
+
+  if (split[kWarmPart]) {
+    AddPartDescription(kWarmPart, block->section(), &parts[kWarmPart],
+                       subgraph);
+  }
+
+  if (split[kColdPart]) {
+    BlockGraph::Section* cold_section = block_graph->FindOrAddSection(
+        cold_section_name_, pe::kCodeCharacteristics);
+    if (cold_section == NULL) {
+      LOG(ERROR) << "Failed to add the " << cold_section_name_ << " section.";
+      return false;
+    }
+    AddPartDescription(kColdPart, cold_section->id(), &parts[kColdPart],
+                       subgraph);
+  }
+
+  return true;
+}
+
+}  // namespace transforms
+}  // namespace optimize
@@ -0,0 +1,92 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This class implements the function splitting transformation. It uses the
+// basic block profile of each executed function to split it in up to three
+// parts:
+//
+//   1. The hot part keeps the entry of the function and stays in its block.
+//   2. The warm part holds the basic blocks of hot functions that run on
+//      fewer than kWarmRatio of the calls to the function. It becomes a block
+//      of its own, in the same section.
+//   3. The cold part holds the basic blocks that never ran. It becomes a block
+//      of its own, in the cold section.
+//
+// Functions are hot when their percentile is below
+// ApplicationProfile::kHotPercentile. Parts smaller than kMinPartSize aren't
+// worth the jump to them, and stay in the hot part. Laid out by the
+// HotColdOrderer, the hot parts of the functions then share as few cache lines
+// and pages as possible with code that seldom or never runs.
+
+#ifndef SYZYGY_OPTIMIZE_TRANSFORMS_FUNCTION_SPLITTING_TRANSFORM_H_
+#define SYZYGY_OPTIMIZE_TRANSFORMS_FUNCTION_SPLITTING_TRANSFORM_H_
+
+#include <string>
+
+#include "base/strings/string_piece.h"
+#include "syzygy/block_graph/transform_policy.h"
+#include "syzygy/optimize/application_profile.h"
+#include "syzygy/optimize/transforms/subgraph_transform.h"
+
+namespace optimize {
+namespace transforms {
+
+class FunctionSplittingTransform : public SubGraphTransformInterface {
+ public:
+  typedef block_graph::BasicBlockSubGraph BasicBlockSubGraph;
+  typedef block_graph::BlockGraph BlockGraph;
+  typedef block_graph::TransformPolicyInterface TransformPolicyInterface;
+
+  // The name of the section receiving the cold parts, by default.
+  static const char kDefaultColdSectionName[];
+
+  // The basic blocks of hot functions executed fewer times than this ratio
+  // of the function entry count are warm.
+  static const double kWarmRatio;
+
+  // The smallest warm or cold part, in bytes of instructions, that is split
+  // off a function.
+  static const size_t kMinPartSize;
+
+  // Constructor.
+  FunctionSplittingTransform();
+
+  // @name Accessors.
+  // @{
+  const std::string& cold_section_name() const { return cold_section_name_; }
+  void set_cold_section_name(const base::StringPiece& cold_section_name) {
+    cold_section_name.CopyToString(&cold_section_name_);
+  }
+  // @}
+
+  // @name SubGraphTransformInterface implementation.
+  // @{
+  virtual bool TransformBasicBlockSubGraph(
+      const TransformPolicyInterface* policy,
+      BlockGraph* block_graph,
+      BasicBlockSubGraph* subgraph,
+      ApplicationProfile* profile,
+      SubGraphProfile* subgraph_profile) override;
+  // @}
+
+ private:
+  std::string cold_section_name_;
+
+  DISALLOW_COPY_AND_ASSIGN(FunctionSplittingTransform);
+};
+
+}  // namespace transforms
+}  // namespace optimize
+
+#endif  // SYZYGY_OPTIMIZE_TRANSFORMS_FUNCTION_SPLITTING_TRANSFORM_H_
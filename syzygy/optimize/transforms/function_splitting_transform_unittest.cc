@@ -0,0 +1,314 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/optimize/transforms/function_splitting_transform.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/basic_block_decomposer.h"
+#include "syzygy/block_graph/block_builder.h"
+#include "syzygy/block_graph/block_graph.h"
+#include "syzygy/pe/pe_transform_policy.h"
+#include "syzygy/pe/pe_utils.h"
+
+namespace optimize {
+namespace transforms {
+
+namespace {
+
+using block_graph::BasicBlock;
+using block_graph::BasicBlockDecomposer;
+using block_graph::BasicCodeBlock;
+using block_graph::BlockBuilder;
+using block_graph::BlockGraph;
+using block_graph::BasicBlockSubGraph;
+using optimize::ApplicationProfile;
+using optimize::SubGraphProfile;
+using pe::ImageLayout;
+
+typedef BasicBlockSubGraph::BasicBlockOrdering BasicBlockOrdering;
+typedef BasicBlockSubGraph::BlockDescription BlockDescription;
+typedef BasicBlockSubGraph::BlockDescriptionList BlockDescriptionList;
+typedef grinder::basic_block_util::EntryCountType EntryCountType;
+
+//     test eax, eax
+//     je cold
+//     cmp eax, 1
+//     je warm
+//     ret
+//   warm:
+//     mov eax, 1
+//     mov eax, 2
+//     mov eax, 3
+//     ret
+//   cold:
+//     mov eax, 4
+//     mov eax, 5
+//     mov eax, 6
+//     ret
+const uint8_t kCodeSplit[] = {
+    0x85, 0xC0, 0x74, 0x16, 0x83, 0xF8, 0x01, 0x74, 0x01, 0xC3,
+    0xB8, 0x01, 0x00, 0x00, 0x00, 0xB8, 0x02, 0x00, 0x00, 0x00,
+    0xB8, 0x03, 0x00, 0x00, 0x00, 0xC3,
+    0xB8, 0x04, 0x00, 0x00, 0x00, 0xB8, 0x05, 0x00, 0x00, 0x00,
+    0xB8, 0x06, 0x00, 0x00, 0x00, 0xC3 };
+
+// The code basic blocks of kCodeSplit, in order.
+enum SplitBasicBlocks {
+  kEntryBasicBlock,
+  kTestBasicBlock,
+  kReturnBasicBlock,
+  kWarmBasicBlock,
+  kColdBasicBlock,
+  kSplitBasicBlockCount,
+};
+
+// _asm je here
+// _asm xor eax, eax
+// here:
+// _asm ret
+const uint8_t kCodeSmall[] = { 0x74, 0x02, 0x33, 0xC0, 0xC3 };
+
+class TestApplicationProfile : public ApplicationProfile {
+ public:
+  explicit TestApplicationProfile(const ImageLayout* image_layout)
+      : ApplicationProfile(image_layout) {
+  }
+
+  using ApplicationProfile::profiles_;
+};
+
+class TestSubGraphProfile : public SubGraphProfile {
+ public:
+  using SubGraphProfile::basic_blocks_;
+};
+
+class TestBasicBlockProfile : public SubGraphProfile::BasicBlockProfile {
+ public:
+  using SubGraphProfile::BasicBlockProfile::count_;
+};
+
+class FunctionSplittingTransformTest : public testing::Test {
+ public:
+  FunctionSplittingTransformTest()
+      : text_(NULL), split_(NULL), small_(NULL), image_(&block_graph_),
+        profile_(&image_) {
+  }
+
+  virtual void SetUp() {
+    text_ = block_graph_.AddSection(".text", pe::kCodeCharacteristics);
+    DCHECK_NE(reinterpret_cast<BlockGraph::Section*>(NULL), text_);
+
+    split_ = block_graph_.AddBlock(BlockGraph::CODE_BLOCK,
+                                   sizeof(kCodeSplit),
+                                   "split");
+    DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), split_);
+    split_->SetData(kCodeSplit, split_->size());
+    split_->set_section(text_->id());
+
+    small_ = block_graph_.AddBlock(BlockGraph::CODE_BLOCK,
+                                   sizeof(kCodeSmall),
+                                   "small");
+    DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), small_);
+    small_->SetData(kCodeSmall, small_->size());
+    small_->set_section(text_->id());
+  }
+
+  // Sets the profile of the function @p block.
+  void SetProfile(const BlockGraph::Block* block,
+                  EntryCountType count,
+                  double percentile) {
+    ApplicationProfile::BlockProfile block_profile(count, count);
+    block_profile.set_percentile(percentile);
+    profile_.profiles_[block->id()] = block_profile;
+  }
+
+  // Sets the entry count of a basic block.
+  void SetCount(const BasicBlock* bb, EntryCountType count) {
+    const BasicCodeBlock* code_bb = BasicCodeBlock::Cast(bb);
+    ASSERT_NE(reinterpret_cast<const BasicCodeBlock*>(NULL), code_bb);
+    TestBasicBlockProfile bb_profile;
+    bb_profile.count_ = count;
+    subgraph_profile_.basic_blocks_[code_bb] = bb_profile;
+  }
+
+  // Decomposes split_ into @p subgraph, and profiles it.
+  // @param entry_count the entry count of the function.
+  // @param percentile the percentile of the function.
+  // @param warm_count the entry count of the warm basic block.
+  // @param subgraph receives the decomposed function.
+  // @param bbs receives the code basic blocks, in order.
+  void DecomposeSplit(EntryCountType entry_count,
+                      double percentile,
+                      EntryCountType warm_count,
+                      BasicBlockSubGraph* subgraph,
+                      std::vector<BasicBlock*>* bbs);
+
+  // Applies the transform to @p subgraph.
+  bool ApplyTransform(BasicBlockSubGraph* subgraph) {
+    return tx_.TransformBasicBlockSubGraph(&policy_, &block_graph_, subgraph,
+                                           &profile_, &subgraph_profile_);
+  }
+
+ protected:
+  pe::PETransformPolicy policy_;
+  BlockGraph block_graph_;
+  BlockGraph::Section* text_;
+  BlockGraph::Block* split_;
+  BlockGraph::Block* small_;
+  FunctionSplittingTransform tx_;
+  ImageLayout image_;
+  TestApplicationProfile profile_;
+  TestSubGraphProfile subgraph_profile_;
+};
+
+void FunctionSplittingTransformTest::DecomposeSplit(
+    EntryCountType entry_count,
+    double percentile,
+    EntryCountType warm_count,
+    BasicBlockSubGraph* subgraph,
+    std::vector<BasicBlock*>* bbs) {
+  BasicBlockDecomposer decomposer(split_, subgraph);
+  ASSERT_TRUE(decomposer.Decompose());
+  ASSERT_EQ(1u, subgraph->block_descriptions().size());
+
+  const BasicBlockOrdering& order =
+      subgraph->block_descriptions().front().basic_block_order;
+  BasicBlockOrdering::const_iterator it = order.begin();
+  for (; it != order.end(); ++it) {
+    if (BasicCodeBlock::Cast(*it) != NULL)
+      bbs->push_back(*it);
+  }
+  ASSERT_EQ(static_cast<size_t>(kSplitBasicBlockCount), bbs->size());
+
+  // The cold basic block never runs, and has no profile.
+  SetProfile(split_, entry_count, percentile);
+  ASSERT_NO_FATAL_FAILURE(SetCount((*bbs)[kEntryBasicBlock], entry_count));
+  ASSERT_NO_FATAL_FAILURE(SetCount((*bbs)[kTestBasicBlock], entry_count));
+  ASSERT_NO_FATAL_FAILURE(
+      SetCount((*bbs)[kReturnBasicBlock], entry_count - warm_count));
+  ASSERT_NO_FATAL_FAILURE(SetCount((*bbs)[kWarmBasicBlock], warm_count));
+}
+
+}  // namespace
+
+TEST_F(FunctionSplittingTransformTest, DefaultColdSectionName) {
+  EXPECT_EQ(FunctionSplittingTransform::kDefaultColdSectionName,
+            tx_.cold_section_name());
+  tx_.set_cold_section_name(".cold");
+  EXPECT_EQ(".cold", tx_.cold_section_name());
+}
+
+TEST_F(FunctionSplittingTransformTest, SplitHotFunction) {
+  BasicBlockSubGraph subgraph;
+  std::vector<BasicBlock*> bbs;
+  ASSERT_NO_FATAL_FAILURE(DecomposeSplit(100, 0.0, 2, &subgraph, &bbs));
+  ASSERT_TRUE(ApplyTransform(&subgraph));
+
+  const BlockDescriptionList& descriptions = subgraph.block_descriptions();
+  ASSERT_EQ(3u, descriptions.size());
+  BlockDescriptionList::const_iterator description = descriptions.begin();
+
+  // The hot part keeps the end block.
+  const BasicBlockOrdering& hot = description->basic_block_order;
+  ASSERT_EQ(4u, hot.size());
+  BasicBlockOrdering::const_iterator it = hot.begin();
+  EXPECT_EQ(bbs[kEntryBasicBlock], *it++);
+  EXPECT_EQ(bbs[kTestBasicBlock], *it++);
+  EXPECT_EQ(bbs[kReturnBasicBlock], *it++);
+  EXPECT_EQ(BasicBlock::BASIC_END_BLOCK, (*it)->type());
+  EXPECT_EQ(text_->id(), description->section);
+
+  ++description;
+  EXPECT_EQ("split.warm", description->name);
+  EXPECT_EQ(text_->id(), description->section);
+  ASSERT_EQ(1u, description->basic_block_order.size());
+  EXPECT_EQ(bbs[kWarmBasicBlock], description->basic_block_order.front());
+
+  ++description;
+  EXPECT_EQ("split.cold", description->name);
+  const BlockGraph::Section* cold_section =
+      block_graph_.FindSection(
+          FunctionSplittingTransform::kDefaultColdSectionName);
+  ASSERT_NE(reinterpret_cast<const BlockGraph::Section*>(NULL), cold_section);
+  EXPECT_EQ(cold_section->id(), description->section);
+  ASSERT_EQ(1u, description->basic_block_order.size());
+  EXPECT_EQ(bbs[kColdBasicBlock], description->basic_block_order.front());
+
+  // The parts are merged back as blocks of their own.
+  BlockBuilder builder(&block_graph_);
+  ASSERT_TRUE(builder.Merge(&subgraph));
+  ASSERT_EQ(3u, builder.new_blocks().size());
+  EXPECT_EQ(text_->id(), builder.new_blocks()[0]->section());
+  EXPECT_EQ(text_->id(), builder.new_blocks()[1]->section());
+  EXPECT_EQ(cold_section->id(), builder.new_blocks()[2]->section());
+}
+
+TEST_F(FunctionSplittingTransformTest, LukewarmFunctionsHaveNoWarmPart) {
+  BasicBlockSubGraph subgraph;
+  std::vector<BasicBlock*> bbs;
+  ASSERT_NO_FATAL_FAILURE(DecomposeSplit(100, 0.95, 2, &subgraph, &bbs));
+  ASSERT_TRUE(ApplyTransform(&subgraph));
+
+  const BlockDescriptionList& descriptions = subgraph.block_descriptions();
+  ASSERT_EQ(2u, descriptions.size());
+  EXPECT_EQ(5u, descriptions.front().basic_block_order.size());
+  EXPECT_EQ("split.cold", descriptions.back().name);
+  ASSERT_EQ(1u, descriptions.back().basic_block_order.size());
+  EXPECT_EQ(bbs[kColdBasicBlock],
+            descriptions.back().basic_block_order.front());
+}
+
+TEST_F(FunctionSplittingTransformTest, CustomColdSection) {
+  tx_.set_cold_section_name(".cold");
+  BasicBlockSubGraph subgraph;
+  std::vector<BasicBlock*> bbs;
+  ASSERT_NO_FATAL_FAILURE(DecomposeSplit(100, 0.0, 50, &subgraph, &bbs));
+  ASSERT_TRUE(ApplyTransform(&subgraph));
+
+  // The warm basic block runs often enough to stay in the hot part.
+  const BlockDescriptionList& descriptions = subgraph.block_descriptions();
+  ASSERT_EQ(2u, descriptions.size());
+  const BlockGraph::Section* cold_section = block_graph_.FindSection(".cold");
+  ASSERT_NE(reinterpret_cast<const BlockGraph::Section*>(NULL), cold_section);
+  EXPECT_EQ(cold_section->id(), descriptions.back().section);
+}
+
+TEST_F(FunctionSplittingTransformTest, FunctionsThatNeverRanAreNotSplit) {
+  BasicBlockSubGraph subgraph;
+  BasicBlockDecomposer decomposer(split_, &subgraph);
+  ASSERT_TRUE(decomposer.Decompose());
+  ASSERT_TRUE(ApplyTransform(&subgraph));
+  EXPECT_EQ(1u, subgraph.block_descriptions().size());
+  EXPECT_EQ(NULL, block_graph_.FindSection(
+      FunctionSplittingTransform::kDefaultColdSectionName));
+}
+
+TEST_F(FunctionSplittingTransformTest, SmallPartsAreNotSplit) {
+  BasicBlockSubGraph subgraph;
+  BasicBlockDecomposer decomposer(small_, &subgraph);
+  ASSERT_TRUE(decomposer.Decompose());
+  SetProfile(small_, 100, 0.0);
+  BasicBlock* entry =
+      subgraph.block_descriptions().front().basic_block_order.front();
+  ASSERT_NO_FATAL_FAILURE(SetCount(entry, 100));
+
+  // The rest of the function never runs, but is too small to be moved away.
+  ASSERT_TRUE(ApplyTransform(&subgraph));
+  EXPECT_EQ(1u, subgraph.block_descriptions().size());
+}
+
+}  // namespace transforms
+}  // namespace optimize
@@ -69,6 +69,7 @@ using block_graph::Successor;
 using block_graph::analysis::LivenessAnalysis;
 
 typedef ApplicationProfile::BlockProfile BlockProfile;
+typedef grinder::basic_block_util::EntryCountType EntryCountType;
 typedef Instruction::BasicBlockReferenceMap BasicBlockReferenceMap;
 typedef BasicBlockSubGraph::BBCollection BBCollection;
 typedef BasicBlock::Instructions Instructions;
@@ -86,10 +87,10 @@ enum MatchKind {
 // Threshold in bytes to consider a block as a candidate for inlining. This size
 // must be big enough to don't miss good candidates, but small to avoid the
 // overhead of decomposition and simplification of huge block.
-const size_t kCodeSizeThreshold = 25;
+const size_t kCodeSizeThreshold = 32;
 
 // Threshold in bytes to inline a callee in a hot block.
-const size_t kHotCodeSizeThreshold = 15;
+const size_t kHotCodeSizeThreshold = 32;
 
 // Threshold in bytes to inline a callee in a cold block.
 const size_t kColdCodeSizeThreshold = 1;
@@ -519,8 +520,53 @@ size_t EstimateSubgraphSize(BasicBlockSubGraph* subgraph) {
   return size;
 }
 
+// Weighs the benefit of inlining a callee at a call-site against its cost.
+// @param callsite_size the size of the call instruction.
+// @param callee_size the estimated size of the callee once inlined.
+// @param callsite_count the number of times the call-site ran, or zero if
+//     the caller isn't hot.
+// @param growth receives the number of bytes inlining adds to the caller,
+//     counted against the code growth budget.
+// @returns true if the callee is worth inlining, false otherwise.
+bool IsWorthInlining(size_t callsite_size,
+                     size_t callee_size,
+                     EntryCountType callsite_count,
+                     size_t* growth) {
+  DCHECK_NE(reinterpret_cast<size_t*>(NULL), growth);
+
+  // For a small callee, try to replace callee instructions in-place.
+  // This kind of inlining is always a win, and isn't counted as growth.
+  *growth = 0;
+  if (callee_size <= callsite_size + kColdCodeSizeThreshold)
+    return true;
+
+  // Otherwise the call overhead saved at each execution of the call-site
+  // must pay for the code growth.
+  if (callsite_count == 0 || callee_size > kHotCodeSizeThreshold)
+    return false;
+  *growth = callee_size - callsite_size;
+  double benefit = callsite_count * InliningTransform::kCallOverhead;
+  return benefit >= *growth * InliningTransform::kMinBenefitPerByte;
+}
+
+// @returns the size of the code blocks of @p block_graph.
+size_t GetCodeSize(const BlockGraph* block_graph) {
+  DCHECK_NE(reinterpret_cast<const BlockGraph*>(NULL), block_graph);
+  size_t size = 0;
+  BlockGraph::BlockMap::const_iterator it = block_graph->blocks().begin();
+  for (; it != block_graph->blocks().end(); ++it) {
+    if (it->second.type() == BlockGraph::CODE_BLOCK)
+      size += it->second.size();
+  }
+  return size;
+}
+
 }  // namespace
 
+const double InliningTransform::kCallOverhead = 5.0;
+const double InliningTransform::kMinBenefitPerByte = 100.0;
+const double InliningTransform::kCodeGrowthBudgetRatio = 0.02;
+
 bool InliningTransform::TransformBasicBlockSubGraph(
     const TransformPolicyInterface* policy,
     BlockGraph* block_graph,
@@ -540,6 +586,16 @@ bool InliningTransform::TransformBasicBlockSubGraph(
   if (!policy->BlockIsSafeToBasicBlockDecompose(caller))
     return true;
 
+  if (!has_code_growth_budget_) {
+    set_code_growth_budget(static_cast<size_t>(
+        GetCodeSize(block_graph) * kCodeGrowthBudgetRatio));
+  }
+
+  // Only the call-sites of hot functions are weighed by their profile.
+  const BlockProfile* caller_profile = profile->GetBlockProfile(caller);
+  bool hot_caller = caller_profile->count() != 0 &&
+      caller_profile->percentile() < ApplicationProfile::kHotPercentile;
+
   // The current block will be rebuilt and erased from the block graph. To avoid
   // dangling pointers, the block is removed from the decomposed cache.
   subgraph_cache_.erase(caller->id());
@@ -613,18 +669,15 @@ bool InliningTransform::TransformBasicBlockSubGraph(
       }
 
       // Heuristic to determine whether to inline or not the callee subgraph.
-      bool candidate_for_inlining = false;
-
-      // For a small callee, try to replace callee instructions in-place.
-      // This kind of inlining is always a win.
-      size_t callsite_size = instr.size();
-      if (subgraph_size <= callsite_size + kColdCodeSizeThreshold)
-        candidate_for_inlining = true;
-
-      // TODO(etienneb): Add more rules based on profile data.
-
-      if (!candidate_for_inlining)
+      EntryCountType callsite_count = 0;
+      if (hot_caller)
+        callsite_count = subgraph_profile->GetBasicBlockProfile(bb)->count();
+      size_t growth = 0;
+      if (!IsWorthInlining(instr.size(), subgraph_size, callsite_count,
+                           &growth) ||
+          code_growth_ + growth > code_growth_budget_) {
         continue;
+      }
 
       // If not already decomposed (cached), decompose it.
       if (callee_subgraph.get() == NULL) {
@@ -637,6 +690,7 @@ bool InliningTransform::TransformBasicBlockSubGraph(
                             call_iter, &bb->instructions())) {
         // Inlining successful, remove call-site.
         bb->instructions().erase(call_iter);
+        code_growth_ += growth;
       } else {
         // Inlining was unsuccessful, avoid any further inlining of this block.
         subgraph_cache_[callee->id()] = kHugeBlockSize;
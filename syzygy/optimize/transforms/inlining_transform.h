@@ -17,6 +17,11 @@
 // The inlining expansion replaces a function call site with the body of the
 // callee. It is used to eliminate the time overhead when a function is called.
 //
+// Callees that fit in their call-site are always inlined. Larger callees are
+// inlined at the hot call-sites of hot functions, when the cycles saved by
+// removing the call overhead outweigh the code growth. The growth of the
+// whole image is capped by a budget.
+//
 // TODO(etienneb): The actual implementation does not inline a sequence of
 //    calls like Foo -> Bar -> Bat. This may be addressed by iterating this
 //    function until no changes occurred or by changing the ordering the
@@ -41,8 +46,38 @@ class InliningTransform : public SubGraphTransformInterface {
   typedef block_graph::TransformPolicyInterface TransformPolicyInterface;
   typedef std::map<BlockId, size_t> SubGraphCache;
 
+  // The estimated number of cycles saved each time an inlined call-site
+  // runs: the call, the return, and the stack traffic of the return address.
+  static const double kCallOverhead;
+
+  // The smallest number of cycles saved for each byte of code growth for a
+  // callee to be inlined at a hot call-site.
+  static const double kMinBenefitPerByte;
+
+  // The code growth budget, as a fraction of the size of the code blocks of
+  // the block graph.
+  static const double kCodeGrowthBudgetRatio;
+
   // Constructor.
-  InliningTransform() { }
+  InliningTransform()
+      : code_growth_(0),
+        code_growth_budget_(0),
+        has_code_growth_budget_(false) {
+  }
+
+  // @name Accessors.
+  // @{
+  // @returns the number of bytes of code added by the inlined call-sites.
+  size_t code_growth() const { return code_growth_; }
+
+  // The code growth budget defaults to kCodeGrowthBudgetRatio of the code of
+  // the block graph, computed on the first transformed block.
+  size_t code_growth_budget() const { return code_growth_budget_; }
+  void set_code_growth_budget(size_t code_growth_budget) {
+    code_growth_budget_ = code_growth_budget;
+    has_code_growth_budget_ = true;
+  }
+  // @}
 
   // @name SubGraphTransformInterface implementation.
   // @{
@@ -58,6 +93,11 @@ class InliningTransform : public SubGraphTransformInterface {
   // A cache of decomposed subgraph sizes.
   SubGraphCache subgraph_cache_;
 
+  // The code growth so far, and the budget it must stay within.
+  size_t code_growth_;
+  size_t code_growth_budget_;
+  bool has_code_growth_budget_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(InliningTransform);
 };
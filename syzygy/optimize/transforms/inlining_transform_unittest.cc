@@ -47,6 +47,7 @@ using testing::ElementsAreArray;
 
 typedef BasicBlockSubGraph::BasicCodeBlock BasicCodeBlock;
 typedef BlockGraph::Offset Offset;
+typedef grinder::basic_block_util::EntryCountType EntryCountType;
 
 // This enum is used to drive the contents of the callee.
 enum CalleeKind {
@@ -148,11 +149,41 @@ const uint8_t kCodeIndirectCall[] = {0xFF, 0x55, 0xF8, 0xC3};
 // _asm ret
 const uint8_t kStackCst[] = {0x6A, 0x02, 0x58, 0xC3};
 
+// _asm mov eax, 1
+// _asm mov ecx, 2
+// _asm mov edx, 3
+// _asm add eax, ecx
+// _asm add eax, edx
+// _asm ret
+const uint8_t kCodeMedium[] = {0xB8, 0x01, 0x00, 0x00, 0x00,
+                               0xB9, 0x02, 0x00, 0x00, 0x00,
+                               0xBA, 0x03, 0x00, 0x00, 0x00,
+                               0x03, 0xC1, 0x03, 0xC2, 0xC3};
+
 class TestInliningTransform : public InliningTransform {
  public:
   using InliningTransform::subgraph_cache_;
 };
 
+class TestApplicationProfile : public ApplicationProfile {
+ public:
+  explicit TestApplicationProfile(const ImageLayout* image_layout)
+      : ApplicationProfile(image_layout) {
+  }
+
+  using ApplicationProfile::profiles_;
+};
+
+class TestSubGraphProfile : public SubGraphProfile {
+ public:
+  using SubGraphProfile::basic_blocks_;
+};
+
+class TestBasicBlockProfile : public SubGraphProfile::BasicBlockProfile {
+ public:
+  using SubGraphProfile::BasicBlockProfile::count_;
+};
+
 class InliningTransformTest : public testing::Test {
  public:
   InliningTransformTest()
@@ -160,7 +191,8 @@ class InliningTransformTest : public testing::Test {
         caller_(NULL),
         callee_(NULL),
         image_(&block_graph_),
-        profile_(&image_) {
+        profile_(&image_),
+        callsite_count_(0) {
   }
 
   virtual void SetUp() {
@@ -184,6 +216,7 @@ class InliningTransformTest : public testing::Test {
                          BlockGraph::Block** callee);
   void CreateCallSiteToBlock(BlockGraph::Block* callee);
   void ApplyTransformOnCaller();
+  void MakeCallerHot(EntryCountType callsite_count);
   void SaveCaller();
 
   pe::PETransformPolicy policy_;
@@ -194,8 +227,10 @@ class InliningTransformTest : public testing::Test {
   std::vector<uint8_t> original_;
   BasicBlockSubGraph callee_subgraph_;
   ImageLayout image_;
-  ApplicationProfile profile_;
-  SubGraphProfile subgraph_profile_;
+  TestApplicationProfile profile_;
+  TestSubGraphProfile subgraph_profile_;
+  TestInliningTransform tx_;
+  EntryCountType callsite_count_;
 };
 
 void InliningTransformTest::AddBlockFromBuffer(const uint8_t* data,
@@ -316,11 +351,20 @@ void InliningTransformTest::ApplyTransformOnCaller() {
   BasicBlockDecomposer decomposer(caller_, &subgraph);
   ASSERT_TRUE(decomposer.Decompose());
 
+  // Profile the call-site, if the caller is hot.
+  if (callsite_count_ != 0) {
+    BasicCodeBlock* code =
+        BasicCodeBlock::Cast(*subgraph.basic_blocks().begin());
+    ASSERT_NE(reinterpret_cast<BasicCodeBlock*>(NULL), code);
+    TestBasicBlockProfile bb_profile;
+    bb_profile.count_ = callsite_count_;
+    subgraph_profile_.basic_blocks_[code] = bb_profile;
+  }
+
   // Apply inlining transform.
-  InliningTransform tx;
   ASSERT_TRUE(
-      tx.TransformBasicBlockSubGraph(&policy_, &block_graph_, &subgraph,
-                                     &profile_, &subgraph_profile_));
+      tx_.TransformBasicBlockSubGraph(&policy_, &block_graph_, &subgraph,
+                                      &profile_, &subgraph_profile_));
 
   // Rebuild block.
   BlockBuilder builder(&block_graph_);
@@ -329,6 +373,16 @@ void InliningTransformTest::ApplyTransformOnCaller() {
   caller_ = *builder.new_blocks().begin();
 }
 
+// Makes the caller one of the hottest functions, with its call-site run
+// @p callsite_count times.
+void InliningTransformTest::MakeCallerHot(EntryCountType callsite_count) {
+  ApplicationProfile::BlockProfile block_profile(callsite_count,
+                                                 callsite_count);
+  block_profile.set_percentile(0.0);
+  profile_.profiles_[caller_->id()] = block_profile;
+  callsite_count_ = callsite_count;
+}
+
 }  // namespace
 
 TEST_F(InliningTransformTest, SubgraphCache) {
@@ -650,5 +704,72 @@ TEST_F(InliningTransformTest, InlineTrampolineToCaller) {
   EXPECT_EQ(caller_, reference.referenced());
 }
 
+TEST_F(InliningTransformTest, InlineMediumBodyAtHotCallSite) {
+  ASSERT_NO_FATAL_FAILURE(
+      AddBlockFromBuffer(kCodeMedium, sizeof(kCodeMedium), &callee_));
+  ASSERT_NO_FATAL_FAILURE(CreateCallSiteToBlock(callee_));
+  ASSERT_NO_FATAL_FAILURE(MakeCallerHot(1000));
+  tx_.set_code_growth_budget(100);
+  ASSERT_NO_FATAL_FAILURE(ApplyTransformOnCaller());
+
+  // The body replaces the call, and the caller keeps its return.
+  EXPECT_THAT(kCodeMedium, ElementsAreArray(caller_->data(), caller_->size()));
+  EXPECT_EQ(sizeof(kCodeMedium) - 5, tx_.code_growth());
+}
+
+TEST_F(InliningTransformTest, DontInlineMediumBodyAtColdCallSite) {
+  ASSERT_NO_FATAL_FAILURE(
+      AddBlockFromBuffer(kCodeMedium, sizeof(kCodeMedium), &callee_));
+  ASSERT_NO_FATAL_FAILURE(CreateCallSiteToBlock(callee_));
+  tx_.set_code_growth_budget(100);
+  ASSERT_NO_FATAL_FAILURE(ApplyTransformOnCaller());
+
+  EXPECT_THAT(original_, ElementsAreArray(caller_->data(), caller_->size()));
+  EXPECT_EQ(0U, tx_.code_growth());
+}
+
+TEST_F(InliningTransformTest, DontInlineMediumBodyAtRareCallSite) {
+  ASSERT_NO_FATAL_FAILURE(
+      AddBlockFromBuffer(kCodeMedium, sizeof(kCodeMedium), &callee_));
+  ASSERT_NO_FATAL_FAILURE(CreateCallSiteToBlock(callee_));
+  ASSERT_NO_FATAL_FAILURE(MakeCallerHot(10));
+  tx_.set_code_growth_budget(100);
+  ASSERT_NO_FATAL_FAILURE(ApplyTransformOnCaller());
+
+  // The call overhead saved doesn't pay for the code growth.
+  EXPECT_THAT(original_, ElementsAreArray(caller_->data(), caller_->size()));
+}
+
+TEST_F(InliningTransformTest, DontInlineBeyondCodeGrowthBudget) {
+  ASSERT_NO_FATAL_FAILURE(
+      AddBlockFromBuffer(kCodeMedium, sizeof(kCodeMedium), &callee_));
+  ASSERT_NO_FATAL_FAILURE(CreateCallSiteToBlock(callee_));
+  ASSERT_NO_FATAL_FAILURE(MakeCallerHot(1000));
+  tx_.set_code_growth_budget(10);
+  ASSERT_NO_FATAL_FAILURE(ApplyTransformOnCaller());
+
+  EXPECT_THAT(original_, ElementsAreArray(caller_->data(), caller_->size()));
+  EXPECT_EQ(0U, tx_.code_growth());
+}
+
+TEST_F(InliningTransformTest, DefaultCodeGrowthBudget) {
+  ASSERT_NO_FATAL_FAILURE(
+      AddBlockFromBuffer(kCodeRet0, sizeof(kCodeRet0), &callee_));
+  ASSERT_NO_FATAL_FAILURE(CreateCallSiteToBlock(callee_));
+  EXPECT_EQ(0U, tx_.code_growth_budget());
+
+  // The budget is a fraction of the code of the block graph.
+  size_t code_size = 0;
+  BlockGraph::BlockMap::const_iterator it = block_graph_.blocks().begin();
+  for (; it != block_graph_.blocks().end(); ++it) {
+    if (it->second.type() == BlockGraph::CODE_BLOCK)
+      code_size += it->second.size();
+  }
+  ASSERT_NO_FATAL_FAILURE(ApplyTransformOnCaller());
+  EXPECT_EQ(static_cast<size_t>(
+                code_size * InliningTransform::kCodeGrowthBudgetRatio),
+            tx_.code_growth_budget());
+}
+
 }  // namespace transforms
 }  // namespace optimize
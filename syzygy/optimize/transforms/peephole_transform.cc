@@ -14,9 +14,14 @@
 
 #include "syzygy/optimize/transforms/peephole_transform.h"
 
+#include <algorithm>
+#include <set>
+
+#include "syzygy/block_graph/basic_block_assembler.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/block_graph/analysis/liveness_analysis.h"
 #include "syzygy/block_graph/analysis/liveness_analysis_internal.h"
+#include "syzygy/core/disassembler_util.h"
 
 namespace optimize {
 namespace transforms {
@@ -24,13 +29,19 @@ namespace transforms {
 namespace {
 
 using block_graph::BasicBlock;
+using block_graph::BasicBlockAssembler;
+using block_graph::BasicBlockReference;
 using block_graph::BasicBlockSubGraph;
 using block_graph::BasicCodeBlock;
+using block_graph::Displacement;
 using block_graph::Instruction;
+using block_graph::Operand;
+using block_graph::Successor;
 using block_graph::analysis::LivenessAnalysis;
 
 typedef BasicBlockSubGraph::BBCollection BBCollection;
 typedef BasicBlock::Instructions Instructions;
+typedef BasicCodeBlock::Successors Successors;
 
 // Match a sequence of three instructions and return them into |instr1|,
 // |instr2| and |instr3|.
@@ -112,6 +123,62 @@ bool MatchInstructionRegReg(const Instruction& instr,
   return false;
 }
 
+// @returns true if |reg| is a 32-bit general purpose register.
+bool IsGeneralRegister32(uint32_t reg) {
+  return reg >= R_EAX && reg <= R_EDI;
+}
+
+// @returns true if |reg| is used to manipulate the stack.
+bool IsStackRegister(_RegisterType reg) {
+  return reg == R_ESP || reg == R_EBP;
+}
+
+// @returns true if no operand of |instr| accesses memory.
+bool HasNoMemoryOperand(const Instruction& instr) {
+  const _DInst& repr = instr.representation();
+  for (size_t i = 0; i < arraysize(repr.ops); ++i) {
+    if (repr.ops[i].type == O_SMEM ||
+        repr.ops[i].type == O_MEM ||
+        repr.ops[i].type == O_DISP) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Validate that a given instruction copies a 32-bit register, plus an
+// optional displacement, into another 32-bit register. This matches patterns
+// like: mov eax, ebx and lea eax, [ebx+4].
+// @param instr the instruction to match.
+// @param dst receives the destination register.
+// @param src receives the source register.
+// @param displacement receives the displacement added to the source.
+// @returns true on a successful match, false otherwise.
+bool MatchRegisterCopy(const Instruction& instr,
+                       _RegisterType* dst,
+                       _RegisterType* src,
+                       uint32_t* displacement) {
+  const _DInst& repr = instr.representation();
+  if (!instr.references().empty() ||
+      repr.ops[0].type != O_REG ||
+      !IsGeneralRegister32(repr.ops[0].index) ||
+      !IsGeneralRegister32(repr.ops[1].index)) {
+    return false;
+  }
+
+  if (repr.opcode == I_MOV && repr.ops[1].type == O_REG) {
+    *displacement = 0;
+  } else if (repr.opcode == I_LEA && repr.ops[1].type == O_SMEM) {
+    *displacement = repr.dispSize == 0 ? 0 : static_cast<uint32_t>(repr.disp);
+  } else {
+    return false;
+  }
+
+  *dst = static_cast<_RegisterType>(repr.ops[0].index);
+  *src = static_cast<_RegisterType>(repr.ops[1].index);
+  return true;
+}
+
 bool SimplifyEmptyPrologEpilog(Instructions* instructions,
                                Instructions::iterator* where) {
   DCHECK_NE(reinterpret_cast<Instructions*>(NULL), instructions);
@@ -153,6 +220,132 @@ bool SimplifyIdentityMov(Instructions* instructions,
   return false;
 }
 
+// Remove a compare which sets the flags exactly like the instruction before
+// it, like the second compare of: cmp eax, ebx; cmp eax, ebx or the test of:
+// and eax, 1; test eax, eax.
+bool SimplifyRedundantCompare(Instructions* instructions,
+                              Instructions::iterator* where) {
+  DCHECK_NE(reinterpret_cast<Instructions*>(NULL), instructions);
+  DCHECK_NE(reinterpret_cast<Instructions::iterator*>(NULL), where);
+
+  Instructions::iterator compare_iter = *where;
+  ++compare_iter;
+  if (compare_iter == instructions->end())
+    return false;
+
+  const Instruction& instr = **where;
+  const Instruction& compare = *compare_iter;
+  const _DInst& repr = instr.representation();
+  const _DInst& compare_repr = compare.representation();
+  if ((compare_repr.opcode != I_CMP && compare_repr.opcode != I_TEST) ||
+      !compare.references().empty()) {
+    return false;
+  }
+
+  // A compare of registers and immediates repeating the previous one.
+  bool redundant = false;
+  if (repr.opcode == compare_repr.opcode &&
+      instr.references().empty() &&
+      HasNoMemoryOperand(compare) &&
+      instr.size() == compare.size() &&
+      std::equal(compare.data(), compare.data() + compare.size(),
+                 instr.data())) {
+    redundant = true;
+  }
+
+  // A test of a register against itself, after a logical operation on that
+  // register. Both set the sign, zero and parity flags from the register, and
+  // clear the carry and overflow flags.
+  _RegisterType reg1 = _RegisterType();
+  _RegisterType reg2 = _RegisterType();
+  if (MatchInstructionRegReg(compare, I_TEST, &reg1, &reg2) &&
+      reg1 == reg2 &&
+      (MatchInstructionReg(instr, I_AND, reg1) ||
+       MatchInstructionReg(instr, I_OR, reg1) ||
+       MatchInstructionReg(instr, I_XOR, reg1))) {
+    redundant = true;
+  }
+
+  if (!redundant)
+    return false;
+
+  // Remove the matched compare.
+  instructions->erase(compare_iter);
+  return true;
+}
+
+// Fold the register copy at |where| with the register copy before it, when
+// the intermediate register is dead according to |state|, the liveness
+// information after |where|. On success, |where| is moved to the folded
+// instruction.
+bool FoldCopyChain(const LivenessAnalysis::State& state,
+                   Instructions* instructions,
+                   Instructions::iterator* where) {
+  DCHECK_NE(reinterpret_cast<Instructions*>(NULL), instructions);
+  DCHECK_NE(reinterpret_cast<Instructions::iterator*>(NULL), where);
+  DCHECK(*where != instructions->begin());
+
+  Instructions::iterator first = *where;
+  --first;
+
+  _RegisterType dst1 = _RegisterType();
+  _RegisterType src1 = _RegisterType();
+  _RegisterType dst2 = _RegisterType();
+  _RegisterType src2 = _RegisterType();
+  uint32_t displacement1 = 0;
+  uint32_t displacement2 = 0;
+  if (!MatchRegisterCopy(*first, &dst1, &src1, &displacement1) ||
+      !MatchRegisterCopy(**where, &dst2, &src2, &displacement2) ||
+      src2 != dst1 ||
+      src1 == dst1) {
+    return false;
+  }
+
+  // Avoid stack manipulation.
+  if (IsStackRegister(dst1) || IsStackRegister(src1) || IsStackRegister(dst2))
+    return false;
+
+  // The intermediate register must not be used after the chain, unless the
+  // chain overwrites it.
+  if (dst2 != dst1 && state.IsLive(core::GetRegister(dst1)))
+    return false;
+
+  // Replace the chain by a single copy.
+  Instruction::SourceRange source_range = (*where)->source_range();
+  instructions->erase(first);
+  Instructions::iterator next = instructions->erase(*where);
+
+  const assm::Register32& dst =
+      assm::CastAsRegister32(core::GetRegister(dst2));
+  const assm::Register32& src =
+      assm::CastAsRegister32(core::GetRegister(src1));
+  uint32_t displacement = displacement1 + displacement2;
+  BasicBlockAssembler assm(next, instructions);
+  assm.set_source_range(source_range);
+  if (displacement == 0)
+    assm.mov(dst, src);
+  else
+    assm.lea(dst, Operand(src, Displacement(displacement)));
+
+  *where = next;
+  --(*where);
+  return true;
+}
+
+// Returns the final destination of an empty basic block which only jumps to
+// an other basic block, or NULL if |basic_block| does anything else.
+BasicBlock* GetJumpTarget(BasicBlock* basic_block) {
+  BasicCodeBlock* bb = BasicCodeBlock::Cast(basic_block);
+  if (bb == NULL ||
+      !bb->instructions().empty() ||
+      bb->successors().size() != 1 ||
+      bb->successors().front().condition() != Successor::kConditionTrue) {
+    return NULL;
+  }
+
+  return bb->successors().front().reference().basic_block();
+}
+
 // Simplify a given basic block.
 bool SimplifyBasicBlock(BasicBlock* basic_block) {
   DCHECK_NE(reinterpret_cast<BasicBlock*>(NULL), basic_block);
@@ -167,7 +360,8 @@ bool SimplifyBasicBlock(BasicBlock* basic_block) {
   BasicBlock::Instructions::iterator inst_iter = bb->instructions().begin();
   while (inst_iter != bb->instructions().end()) {
     if (SimplifyEmptyPrologEpilog(&bb->instructions(), &inst_iter) ||
-        SimplifyIdentityMov(&bb->instructions(), &inst_iter)) {
+        SimplifyIdentityMov(&bb->instructions(), &inst_iter) ||
+        SimplifyRedundantCompare(&bb->instructions(), &inst_iter)) {
       changed = true;
       continue;
     }
@@ -197,15 +391,22 @@ bool PeepholeTransform::SimplifySubgraph(BasicBlockSubGraph* subgraph) {
 }
 
 bool PeepholeTransform::RemoveDeadCodeSubgraph(BasicBlockSubGraph* subgraph) {
+  LivenessAnalysis liveness;
+  return RemoveDeadCodeSubgraph(subgraph, &liveness);
+}
+
+bool PeepholeTransform::RemoveDeadCodeSubgraph(BasicBlockSubGraph* subgraph,
+                                               LivenessAnalysis* liveness) {
   DCHECK_NE(reinterpret_cast<BasicBlockSubGraph*>(NULL), subgraph);
+  DCHECK_NE(reinterpret_cast<LivenessAnalysis*>(NULL), liveness);
 
   bool changed = false;
   BBCollection& basic_blocks = subgraph->basic_blocks();
   BBCollection::iterator it = basic_blocks.begin();
 
-  // Perform a global liveness analysis.
-  LivenessAnalysis liveness;
-  liveness.Analyze(subgraph);
+  // Perform a global liveness analysis. The basic blocks left untouched since
+  // the previous analysis are not summarized again.
+  liveness->Analyze(subgraph);
 
   // For each basic block, remove dead instructions.
   for (; it != basic_blocks.end(); ++it) {
@@ -215,7 +416,7 @@ bool PeepholeTransform::RemoveDeadCodeSubgraph(BasicBlockSubGraph* subgraph) {
 
     // Get the liveness state information at the end of this basic block.
     LivenessAnalysis::State state;
-    liveness.GetStateAtExitOf(basic_block, &state);
+    liveness->GetStateAtExitOf(basic_block, &state);
 
     // Perform a backward traversal to cleanup the code.
     Instructions::reverse_iterator rev_iter_inst =
@@ -307,7 +508,82 @@ bool PeepholeTransform::RemoveDeadCodeSubgraph(BasicBlockSubGraph* subgraph) {
       }
 
       // Propagate the liveness information for the next instruction.
-      liveness.PropagateBackward(instr, &state);
+      liveness->PropagateBackward(instr, &state);
+    }
+  }
+
+  return changed;
+}
+
+bool PeepholeTransform::FoldCopyChainsSubgraph(BasicBlockSubGraph* subgraph,
+                                               LivenessAnalysis* liveness) {
+  DCHECK_NE(reinterpret_cast<BasicBlockSubGraph*>(NULL), subgraph);
+  DCHECK_NE(reinterpret_cast<LivenessAnalysis*>(NULL), liveness);
+
+  bool changed = false;
+  BBCollection& basic_blocks = subgraph->basic_blocks();
+  BBCollection::iterator it = basic_blocks.begin();
+
+  // Perform a global liveness analysis.
+  liveness->Analyze(subgraph);
+
+  for (; it != basic_blocks.end(); ++it) {
+    BasicCodeBlock* basic_block = BasicCodeBlock::Cast(*it);
+    if (basic_block == NULL)
+      continue;
+
+    LivenessAnalysis::State state;
+    liveness->GetStateAtExitOf(basic_block, &state);
+
+    // Perform a backward traversal, keeping the liveness information after
+    // the current instruction in |state|.
+    Instructions& instructions = basic_block->instructions();
+    Instructions::iterator inst_iter = instructions.end();
+    while (inst_iter != instructions.begin()) {
+      --inst_iter;
+      if (inst_iter != instructions.begin() &&
+          FoldCopyChain(state, &instructions, &inst_iter)) {
+        changed = true;
+      }
+      liveness->PropagateBackward(*inst_iter, &state);
+    }
+  }
+
+  return changed;
+}
+
+bool PeepholeTransform::ThreadJumpsSubgraph(BasicBlockSubGraph* subgraph) {
+  DCHECK_NE(reinterpret_cast<BasicBlockSubGraph*>(NULL), subgraph);
+
+  bool changed = false;
+  BBCollection& basic_blocks = subgraph->basic_blocks();
+  BBCollection::iterator it = basic_blocks.begin();
+  for (; it != basic_blocks.end(); ++it) {
+    BasicCodeBlock* basic_block = BasicCodeBlock::Cast(*it);
+    if (basic_block == NULL)
+      continue;
+
+    Successors::iterator succ = basic_block->successors().begin();
+    for (; succ != basic_block->successors().end(); ++succ) {
+      const BasicBlockReference& ref = succ->reference();
+      BasicBlock* target = ref.basic_block();
+      if (target == NULL)
+        continue;
+
+      // Follow the chain of jumps, which may loop.
+      std::set<BasicBlock*> visited;
+      visited.insert(target);
+      BasicBlock* next = GetJumpTarget(target);
+      while (next != NULL && visited.insert(next).second) {
+        target = next;
+        next = GetJumpTarget(target);
+      }
+
+      if (target != ref.basic_block()) {
+        succ->set_reference(
+            BasicBlockReference(ref.reference_type(), ref.size(), target));
+        changed = true;
+      }
     }
   }
 
@@ -326,13 +602,19 @@ bool PeepholeTransform::TransformBasicBlockSubGraph(
   DCHECK_NE(reinterpret_cast<ApplicationProfile*>(NULL), profile);
   DCHECK_NE(reinterpret_cast<SubGraphProfile*>(NULL), subgraph_profile);
 
+  // The liveness analysis is shared by the iterations.
+  LivenessAnalysis liveness;
   bool changed = false;
   do {
     changed = false;
 
     if (SimplifySubgraph(subgraph))
       changed = true;
-    if (RemoveDeadCodeSubgraph(subgraph))
+    if (ThreadJumpsSubgraph(subgraph))
+      changed = true;
+    if (FoldCopyChainsSubgraph(subgraph, &liveness))
+      changed = true;
+    if (RemoveDeadCodeSubgraph(subgraph, &liveness))
       changed = true;
   } while (changed);
 
@@ -21,6 +21,7 @@
 #define SYZYGY_OPTIMIZE_TRANSFORMS_PEEPHOLE_TRANSFORM_H_
 
 #include "syzygy/block_graph/filterable.h"
+#include "syzygy/block_graph/analysis/liveness_analysis.h"
 #include "syzygy/block_graph/transform_policy.h"
 #include "syzygy/optimize/application_profile.h"
 #include "syzygy/optimize/transforms/subgraph_transform.h"
@@ -35,6 +36,7 @@ class PeepholeTransform : public SubGraphTransformInterface {
   typedef block_graph::BasicBlockSubGraph BasicBlockSubGraph;
   typedef block_graph::BlockGraph BlockGraph;
   typedef block_graph::TransformPolicyInterface TransformPolicyInterface;
+  typedef block_graph::analysis::LivenessAnalysis LivenessAnalysis;
 
   // Constructor.
   PeepholeTransform() { }
@@ -63,6 +65,29 @@ class PeepholeTransform : public SubGraphTransformInterface {
   // @returns true if the subgraph has been simplified, false otherwise.
   static bool RemoveDeadCodeSubgraph(BasicBlockSubGraph* subgraph);
 
+  // Remove dead instructions in the contents of a subgraph, using a liveness
+  // analysis that may have been computed over previous versions of it.
+  // @param subgraph the subgraph to simplify.
+  // @param liveness the liveness analysis to recompute and use.
+  // @returns true if the subgraph has been simplified, false otherwise.
+  static bool RemoveDeadCodeSubgraph(BasicBlockSubGraph* subgraph,
+                                     LivenessAnalysis* liveness);
+
+  // Fold the chains of register copies like: mov eax, ebx; lea ecx, [eax+4]
+  // into a single instruction, when the intermediate register is dead after
+  // the chain. The folding is applied once.
+  // @param subgraph the subgraph to simplify.
+  // @param liveness the liveness analysis to recompute and use.
+  // @returns true if the subgraph has been simplified, false otherwise.
+  static bool FoldCopyChainsSubgraph(BasicBlockSubGraph* subgraph,
+                                     LivenessAnalysis* liveness);
+
+  // Redirect the branches to empty basic blocks which only jump elsewhere in
+  // the subgraph to their final destination.
+  // @param subgraph the subgraph to simplify.
+  // @returns true if the subgraph has been simplified, false otherwise.
+  static bool ThreadJumpsSubgraph(BasicBlockSubGraph* subgraph);
+
  private:
   DISALLOW_COPY_AND_ASSIGN(PeepholeTransform);
 };
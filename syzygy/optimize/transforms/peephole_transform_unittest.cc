@@ -218,5 +218,126 @@ TEST_F(PeepholeTransformTest, RemoveDeadCodeSubgraphWith8BitRegister) {
   EXPECT_THAT(kSource, ElementsAreArray(block_->data(), block_->size()));
 }
 
+TEST_F(PeepholeTransformTest, SimplifyRedundantCompare) {
+  // _asm cmp eax, ebx
+  // _asm cmp eax, ebx
+  // _asm ret
+  const uint8_t kSource[] = {0x3B, 0xC3, 0x3B, 0xC3, 0xC3};
+
+  // _asm cmp eax, ebx
+  // _asm ret
+  const uint8_t kResult[] = {0x3B, 0xC3, 0xC3};
+
+  ASSERT_NO_FATAL_FAILURE(
+      TransformBlock(ktransformSubgraph, kSource, sizeof(kSource)));
+  EXPECT_THAT(kResult, ElementsAreArray(block_->data(), block_->size()));
+}
+
+TEST_F(PeepholeTransformTest, SimplifyTestAfterLogicalOperation) {
+  // _asm and eax, 1
+  // _asm test eax, eax
+  // _asm ret
+  const uint8_t kSource[] = {0x83, 0xE0, 0x01, 0x85, 0xC0, 0xC3};
+
+  // _asm and eax, 1
+  // _asm ret
+  const uint8_t kResult[] = {0x83, 0xE0, 0x01, 0xC3};
+
+  ASSERT_NO_FATAL_FAILURE(
+      TransformBlock(ktransformSubgraph, kSource, sizeof(kSource)));
+  EXPECT_THAT(kResult, ElementsAreArray(block_->data(), block_->size()));
+}
+
+TEST_F(PeepholeTransformTest, TestAfterArithmeticOperationIsKept) {
+  // _asm sub eax, 1
+  // _asm test eax, eax
+  // _asm ret
+  const uint8_t kSource[] = {0x83, 0xE8, 0x01, 0x85, 0xC0, 0xC3};
+
+  // The subtraction sets the carry and overflow flags, unlike the test.
+  ASSERT_NO_FATAL_FAILURE(
+      TransformBlock(ktransformSubgraph, kSource, sizeof(kSource)));
+  EXPECT_THAT(kSource, ElementsAreArray(block_->data(), block_->size()));
+}
+
+TEST_F(PeepholeTransformTest, FoldMovLeaChain) {
+  // _asm mov eax, ebx
+  // _asm lea ecx, [eax + 4]
+  // _asm xor eax, eax
+  // _asm ret
+  const uint8_t kSource[] = {0x8B, 0xC3, 0x8D, 0x48, 0x04, 0x33, 0xC0, 0xC3};
+
+  // _asm lea ecx, [ebx + 4]
+  // _asm xor eax, eax
+  // _asm ret
+  const uint8_t kResult[] = {0x8D, 0x4B, 0x04, 0x33, 0xC0, 0xC3};
+
+  ASSERT_NO_FATAL_FAILURE(
+      TransformBlock(ktransformBlock, kSource, sizeof(kSource)));
+  EXPECT_THAT(kResult, ElementsAreArray(block_->data(), block_->size()));
+}
+
+TEST_F(PeepholeTransformTest, FoldLeaChainToMov) {
+  // _asm lea eax, [ebx + 4]
+  // _asm lea ecx, [eax - 4]
+  // _asm xor eax, eax
+  // _asm ret
+  const uint8_t kSource[] =
+      {0x8D, 0x43, 0x04, 0x8D, 0x48, 0xFC, 0x33, 0xC0, 0xC3};
+
+  // _asm mov ecx, ebx
+  // _asm xor eax, eax
+  // _asm ret
+  const uint8_t kResult[] = {0x8B, 0xCB, 0x33, 0xC0, 0xC3};
+
+  ASSERT_NO_FATAL_FAILURE(
+      TransformBlock(ktransformBlock, kSource, sizeof(kSource)));
+  EXPECT_THAT(kResult, ElementsAreArray(block_->data(), block_->size()));
+}
+
+TEST_F(PeepholeTransformTest, ChainWithLiveRegisterIsKept) {
+  // _asm mov eax, ebx
+  // _asm lea ecx, [eax + 4]
+  // _asm ret
+  const uint8_t kSource[] = {0x8B, 0xC3, 0x8D, 0x48, 0x04, 0xC3};
+
+  // This code is not simplified. The intermediate register is returned.
+  ASSERT_NO_FATAL_FAILURE(
+      TransformBlock(ktransformBlock, kSource, sizeof(kSource)));
+  EXPECT_THAT(kSource, ElementsAreArray(block_->data(), block_->size()));
+}
+
+TEST_F(PeepholeTransformTest, ThreadJumps) {
+  // 0: _asm test eax, eax
+  // 2: _asm je 7
+  // 4: _asm xor eax, eax
+  // 6: _asm ret
+  // 7: _asm jmp 4
+  const uint8_t kSource[] =
+      {0x85, 0xC0, 0x74, 0x03, 0x33, 0xC0, 0xC3, 0xEB, 0xFB};
+
+  block_ = block_graph_.AddBlock(BlockGraph::CODE_BLOCK, sizeof(kSource),
+                                 "test");
+  block_->SetData(kSource, sizeof(kSource));
+  block_->SetLabel(0, "code", BlockGraph::CODE_LABEL);
+  BasicBlockSubGraph subgraph;
+  BasicBlockDecomposer decomposer(block_, &subgraph);
+  ASSERT_TRUE(decomposer.Decompose());
+
+  EXPECT_TRUE(PeepholeTransform::ThreadJumpsSubgraph(&subgraph));
+  EXPECT_FALSE(PeepholeTransform::ThreadJumpsSubgraph(&subgraph));
+
+  // Both branches of the first basic block now go to the xor.
+  BasicCodeBlock* bb = BasicCodeBlock::Cast(subgraph.basic_blocks().front());
+  ASSERT_TRUE(bb != NULL);
+  ASSERT_EQ(2U, bb->successors().size());
+  BasicCodeBlock::Successors::const_iterator succ = bb->successors().begin();
+  for (; succ != bb->successors().end(); ++succ) {
+    BasicBlock* target = succ->reference().basic_block();
+    ASSERT_TRUE(target != NULL);
+    EXPECT_EQ(4, target->offset());
+  }
+}
+
 }  // namespace transforms
 }  // namespace optimize
@@ -62,7 +62,9 @@ class AddNamedStreamMutatorImpl : public NamedPdbMutatorImpl<DerivedType> {
   scoped_refptr<PdbStream> GetNamedStream(const base::StringPiece& name) const;
 
   // A utility function for adding an individual name stream to a PDB. If a
-  // stream already exists with this name, it will be replaced.
+  // stream already exists with this name, it will be replaced. Large streams
+  // needn't be materialized: a PdbProducerStream generates its contents as
+  // the PDB is written.
   // @param name the name of the stream to add.
   // @param stream the stream to add.
   // @returns true if the stream was added, false if it replaced an existing
@@ -16,11 +16,20 @@
 
 #include <algorithm>
 
+#include "base/logging.h"
+
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_util.h"
 
 namespace pdb {
 
+namespace {
+
+// The log2 of the smallest page size used by OmapIndex.
+const size_t kMinPageShift = 12;
+
+}  // namespace
+
 OMAP CreateOmap(ULONG rva, ULONG rvaTo) {
   OMAP omap = { rva, rvaTo };
   return omap;
@@ -58,6 +67,75 @@ core::RelativeAddress TranslateAddressViaOmap(const std::vector<OMAP>& omaps,
       (address - core::RelativeAddress(it->rva));
 }
 
+void TranslateAddressesViaOmap(const std::vector<OMAP>& omaps,
+                               std::vector<core::RelativeAddress>* addresses) {
+  DCHECK(addresses != NULL);
+
+  OmapIndex omap_index;
+  omap_index.Init(omaps);
+  for (size_t i = 0; i < addresses->size(); ++i)
+    (*addresses)[i] = omap_index.Translate((*addresses)[i]);
+}
+
+OmapIndex::OmapIndex() : base_(0), page_shift_(kMinPageShift) {
+}
+
+void OmapIndex::Init(const std::vector<OMAP>& omaps) {
+  DCHECK(OmapVectorIsValid(omaps));
+
+  omaps_ = omaps;
+  page_begins_.clear();
+  base_ = 0;
+  page_shift_ = kMinPageShift;
+  if (omaps_.empty())
+    return;
+
+  // Grow the pages until there are no more of them than there are entries,
+  // so that the index is no larger than the OMAP vector itself.
+  base_ = omaps_.front().rva & ~((1u << kMinPageShift) - 1);
+  ULONG span = omaps_.back().rva - base_;
+  while ((span >> page_shift_) > omaps_.size())
+    ++page_shift_;
+  size_t page_count = (span >> page_shift_) + 1;
+
+  // Walk the pages and the entries together.
+  page_begins_.resize(page_count + 1);
+  size_t omap_index = 0;
+  for (size_t i = 0; i <= page_count; ++i) {
+    uint64_t page_start =
+        base_ + (static_cast<uint64_t>(i) << page_shift_);
+    while (omap_index < omaps_.size() && omaps_[omap_index].rva < page_start)
+      ++omap_index;
+    page_begins_[i] = omap_index;
+  }
+}
+
+core::RelativeAddress OmapIndex::Translate(
+    core::RelativeAddress address) const {
+  // Addresses before the first OMAP entry are not OMAPped.
+  if (omaps_.empty() || address.value() < omaps_.front().rva)
+    return address;
+
+  // Find the first element that is > than address. Every entry of the pages
+  // before that of address is <= address, and every entry of the pages after
+  // it is > address, so the search is limited to the page of address.
+  std::vector<OMAP>::const_iterator it = omaps_.end();
+  size_t page = (address.value() - base_) >> page_shift_;
+  if (page + 1 < page_begins_.size()) {
+    OMAP omap_address = CreateOmap(address.value(), 0);
+    it = std::upper_bound(omaps_.begin() + page_begins_[page],
+                          omaps_.begin() + page_begins_[page + 1],
+                          omap_address,
+                          OmapLess);
+  }
+
+  // The previous OMAP entry tells us where we lie.
+  DCHECK(it != omaps_.begin());
+  --it;
+  return core::RelativeAddress(it->rvaTo) +
+      (address - core::RelativeAddress(it->rva));
+}
+
 bool ReadOmapsFromPdbFile(const PdbFile& pdb_file,
                           std::vector<OMAP>* omap_to,
                           std::vector<OMAP>* omap_from) {
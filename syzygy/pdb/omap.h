@@ -19,6 +19,7 @@
 #include <dbghelp.h>
 #include <vector>
 
+#include "base/macros.h"
 #include "syzygy/core/address.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_reader.h"
@@ -54,6 +55,59 @@ bool OmapVectorIsValid(const std::vector<OMAP>& omaps);
 core::RelativeAddress TranslateAddressViaOmap(const std::vector<OMAP>& omaps,
                                               core::RelativeAddress address);
 
+// Maps a batch of addresses through the given OMAP information. This is
+// equivalent to calling TranslateAddressViaOmap on each address, but builds an
+// OmapIndex once for the whole batch.
+//
+// @param omaps the vector of OMAPs to apply.
+// @param addresses the addresses to map. These are replaced by the mapped
+//     addresses, in place.
+// @pre OmapIsValid(omaps) is true.
+void TranslateAddressesViaOmap(const std::vector<OMAP>& omaps,
+                               std::vector<core::RelativeAddress>* addresses);
+
+// An index over an OMAP vector, for clients that translate many addresses
+// through the same OMAP information. The range of addresses covered by the
+// OMAP entries is split into fixed-size pages, and the index records the
+// first entry of each page. A translation is then a table lookup followed by
+// a binary search over the few entries of a single page, rather than over the
+// whole vector.
+class OmapIndex {
+ public:
+  OmapIndex();
+
+  // Builds the index.
+  //
+  // @param omaps the vector of OMAPs to index. It is copied into the index.
+  // @pre OmapIsValid(omaps) is true.
+  void Init(const std::vector<OMAP>& omaps);
+
+  // Maps an address through the indexed OMAP information. This returns the
+  // same address as TranslateAddressViaOmap does.
+  //
+  // @param address the address to map.
+  // @returns the mapped address.
+  core::RelativeAddress Translate(core::RelativeAddress address) const;
+
+  // @returns true if there are no OMAP entries in the index.
+  bool empty() const { return omaps_.empty(); }
+
+ private:
+  std::vector<OMAP> omaps_;
+
+  // The address of the first page, and the log2 of the size of the pages.
+  ULONG base_;
+  size_t page_shift_;
+
+  // For each page, the index of the first OMAP entry that starts at or beyond
+  // the start of the page. This has one more element than there are pages, so
+  // that the entries of page i are those in
+  // [page_begins_[i], page_begins_[i + 1]).
+  std::vector<size_t> page_begins_;
+
+  DISALLOW_COPY_AND_ASSIGN(OmapIndex);
+};
+
 // Reads OMAP tables from a PdbFile. The destination vectors may be NULL if
 // they are not required to be read. Even if neither stream is read they will be
 // checked for existence.
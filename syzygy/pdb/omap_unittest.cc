@@ -82,6 +82,66 @@ TEST(OmapTest, Translate) {
             TranslateAddressViaOmap(omaps, RelativeAddress(3500)));
 }
 
+TEST(OmapTest, TranslateAddresses) {
+  std::vector<OMAP> omaps;
+  omaps.push_back(CreateOmap(1000, 2000));
+  omaps.push_back(CreateOmap(2000, 1000));
+  omaps.push_back(CreateOmap(3000, 3000));
+
+  std::vector<RelativeAddress> addresses;
+  addresses.push_back(RelativeAddress(2500));
+  addresses.push_back(RelativeAddress(500));
+  addresses.push_back(RelativeAddress(3500));
+  addresses.push_back(RelativeAddress(1500));
+  TranslateAddressesViaOmap(omaps, &addresses);
+
+  ASSERT_EQ(4u, addresses.size());
+  EXPECT_EQ(RelativeAddress(1500), addresses[0]);
+  EXPECT_EQ(RelativeAddress(500), addresses[1]);
+  EXPECT_EQ(RelativeAddress(3500), addresses[2]);
+  EXPECT_EQ(RelativeAddress(2500), addresses[3]);
+}
+
+TEST(OmapTest, OmapIndexEmpty) {
+  OmapIndex omap_index;
+  EXPECT_TRUE(omap_index.empty());
+  EXPECT_EQ(RelativeAddress(1234), omap_index.Translate(RelativeAddress(1234)));
+
+  omap_index.Init(std::vector<OMAP>());
+  EXPECT_TRUE(omap_index.empty());
+  EXPECT_EQ(RelativeAddress(1234), omap_index.Translate(RelativeAddress(1234)));
+}
+
+TEST(OmapTest, OmapIndexMatchesTranslate) {
+  // Build a mapping with entries of varying density: several to a page in
+  // places, and pages without any entries elsewhere.
+  std::vector<OMAP> omaps;
+  ULONG rva = 0x1010;
+  for (size_t i = 0; i < 500; ++i) {
+    omaps.push_back(CreateOmap(rva, 0x100000 - rva));
+    rva += (i % 7 == 0) ? 0x3000 + i : 0x10 + i;
+  }
+  ASSERT_TRUE(OmapVectorIsValid(omaps));
+
+  OmapIndex omap_index;
+  omap_index.Init(omaps);
+  EXPECT_FALSE(omap_index.empty());
+
+  for (ULONG address = 0; address < rva + 0x2000; address += 3) {
+    EXPECT_EQ(TranslateAddressViaOmap(omaps, RelativeAddress(address)),
+              omap_index.Translate(RelativeAddress(address)));
+  }
+
+  // Each entry and the address just before it.
+  for (size_t i = 0; i < omaps.size(); ++i) {
+    RelativeAddress address(omaps[i].rva);
+    EXPECT_EQ(TranslateAddressViaOmap(omaps, address),
+              omap_index.Translate(address));
+    EXPECT_EQ(TranslateAddressViaOmap(omaps, address - 1),
+              omap_index.Translate(address - 1));
+  }
+}
+
 TEST(OmapTest, ReadOmapsFromPdbFile) {
   std::vector<OMAP> omap_to, omap_from;
 
@@ -40,12 +40,15 @@
         'pdb_file_stream.h',
         'pdb_mutator.cc',
         'pdb_mutator.h',
+        'pdb_producer_stream.h',
         'pdb_reader.h',
         'pdb_stream.h',
         'pdb_stream_reader.cc',
         'pdb_stream_reader.h',
         'pdb_stream_record.cc',
         'pdb_stream_record.h',
+        'pdb_string_table.cc',
+        'pdb_string_table.h',
         'pdb_symbol_record.cc',
         'pdb_symbol_record.h',
         'pdb_type_info_stream_enum.cc',
@@ -83,6 +86,7 @@
         'pdb_mutator_unittest.cc',
         'pdb_stream_reader_unittest.cc',
         'pdb_stream_record_unittest.cc',
+        'pdb_string_table_unittest.cc',
         'pdb_symbol_record_unittest.cc',
         'pdb_type_info_records_unittest.cc',
         'pdb_type_info_stream_enum_unittest.cc',
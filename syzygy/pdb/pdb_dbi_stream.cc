@@ -14,6 +14,8 @@
 
 #include "syzygy/pdb/pdb_dbi_stream.h"
 
+#include <algorithm>
+
 #include "base/strings/stringprintf.h"
 #include "syzygy/common/align.h"
 #include "syzygy/pdb/pdb_constants.h"
@@ -338,22 +340,27 @@ bool DbiStream::ReadDbiECInfo(pdb::PdbStream* stream) {
                          &ec_info_vector_);
 }
 
-bool DbiStream::Read(pdb::PdbStream* stream ) {
+bool DbiStream::Read(pdb::PdbStream* stream) {
   DCHECK(stream != NULL);
 
-  if (!ReadDbiHeaders(stream))
+  if (!Init(stream))
     return false;
 
-  if (!ReadDbiModuleInfo(stream))
+  if (!ReadModules() || !ReadSectionContribs() || !ReadSectionMap() ||
+      !ReadFileInfo() || !ReadECInfo()) {
     return false;
+  }
 
-  if (!ReadDbiSectionContribs(stream))
-    return false;
+  // Everything has been read, there's no need to hold on to the stream.
+  stream_ = nullptr;
 
-  if (!ReadDbiSectionMap(stream))
-    return false;
+  return true;
+}
 
-  if (!ReadDbiFileInfo(stream))
+bool DbiStream::Init(pdb::PdbStream* stream) {
+  DCHECK(stream != NULL);
+
+  if (!ReadDbiHeaders(stream))
     return false;
 
   if (header_.ts_map_size != 0) {
@@ -362,10 +369,154 @@ bool DbiStream::Read(pdb::PdbStream* stream ) {
     return false;
   }
 
-  if (!ReadDbiECInfo(stream))
+  stream_ = stream;
+  modules_read_ = false;
+  section_contribs_read_ = false;
+  section_map_read_ = false;
+  file_info_read_ = false;
+  ec_info_read_ = false;
+  module_name_index_.clear();
+  section_contrib_index_.clear();
+
+  return true;
+}
+
+bool DbiStream::ReadModules() {
+  if (modules_read_)
+    return true;
+  DCHECK(stream_.get() != NULL);
+
+  modules_.clear();
+  if (!ReadDbiModuleInfo(stream_.get()))
     return false;
+  modules_read_ = true;
 
   return true;
 }
 
+bool DbiStream::ReadSectionContribs() {
+  if (section_contribs_read_)
+    return true;
+  DCHECK(stream_.get() != NULL);
+
+  section_contribs_.clear();
+  if (!ReadDbiSectionContribs(stream_.get()))
+    return false;
+  section_contribs_read_ = true;
+
+  return true;
+}
+
+bool DbiStream::ReadSectionMap() {
+  if (section_map_read_)
+    return true;
+  DCHECK(stream_.get() != NULL);
+
+  section_map_.clear();
+  if (!ReadDbiSectionMap(stream_.get()))
+    return false;
+  section_map_read_ = true;
+
+  return true;
+}
+
+bool DbiStream::ReadFileInfo() {
+  if (file_info_read_)
+    return true;
+  DCHECK(stream_.get() != NULL);
+
+  file_info_.first.clear();
+  file_info_.second.clear();
+  if (!ReadDbiFileInfo(stream_.get()))
+    return false;
+  file_info_read_ = true;
+
+  return true;
+}
+
+bool DbiStream::ReadECInfo() {
+  if (ec_info_read_)
+    return true;
+  DCHECK(stream_.get() != NULL);
+
+  ec_info_vector_.clear();
+  if (!ReadDbiECInfo(stream_.get()))
+    return false;
+  ec_info_read_ = true;
+
+  return true;
+}
+
+bool DbiStream::FindModule(const std::string& module_name,
+                           size_t* module_index) {
+  DCHECK(module_index != NULL);
+
+  if (!ReadModules())
+    return false;
+
+  if (module_name_index_.empty()) {
+    // Keep the first module of a given name.
+    for (size_t i = 0; i < modules_.size(); ++i)
+      module_name_index_.emplace(modules_[i].module_name(), i);
+  }
+
+  auto it = module_name_index_.find(module_name);
+  if (it == module_name_index_.end())
+    return false;
+  *module_index = it->second;
+
+  return true;
+}
+
+const DbiSectionContrib* DbiStream::FindSectionContrib(uint16_t section,
+                                                       uint32_t offset) {
+  if (!ReadSectionContribs())
+    return nullptr;
+
+  // The contributions don't overlap, so sorting them by address allows them
+  // to be binary searched.
+  auto less = [this](size_t index1, size_t index2) {
+    const DbiSectionContrib& contrib1 = section_contribs_[index1];
+    const DbiSectionContrib& contrib2 = section_contribs_[index2];
+    if (contrib1.section != contrib2.section) {
+      return static_cast<uint16_t>(contrib1.section) <
+             static_cast<uint16_t>(contrib2.section);
+    }
+    return static_cast<uint32_t>(contrib1.offset) <
+           static_cast<uint32_t>(contrib2.offset);
+  };
+  if (section_contrib_index_.empty()) {
+    for (size_t i = 0; i < section_contribs_.size(); ++i) {
+      if (section_contribs_[i].size > 0)
+        section_contrib_index_.push_back(i);
+    }
+    std::sort(section_contrib_index_.begin(), section_contrib_index_.end(),
+              less);
+  }
+
+  // Find the last contribution starting at or before the address.
+  auto it = std::upper_bound(
+      section_contrib_index_.begin(), section_contrib_index_.end(),
+      std::make_pair(section, offset),
+      [this](const std::pair<uint16_t, uint32_t>& address, size_t index) {
+        const DbiSectionContrib& contrib = section_contribs_[index];
+        uint16_t contrib_section = static_cast<uint16_t>(contrib.section);
+        if (address.first != contrib_section)
+          return address.first < contrib_section;
+        return address.second < static_cast<uint32_t>(contrib.offset);
+      });
+  if (it == section_contrib_index_.begin())
+    return nullptr;
+  --it;
+
+  const DbiSectionContrib& contrib = section_contribs_[*it];
+  if (static_cast<uint16_t>(contrib.section) != section ||
+      offset - static_cast<uint32_t>(contrib.offset) >=
+          static_cast<uint32_t>(contrib.size)) {
+    return nullptr;
+  }
+
+  return &contrib;
+}
+
 }  // namespace pdb
@@ -26,15 +26,22 @@
 // - The TS map (but this substream is always empty so we ignore it);
 // - The EC informations; and
 // - The DbiDbgHeader.
+//
+// Read parses all of these at once. Alternatively, Init only reads the headers
+// and the substreams are parsed on first use, so that a tool needing only one
+// of them doesn't pay for the others.
 
 #ifndef SYZYGY_PDB_PDB_DBI_STREAM_H_
 #define SYZYGY_PDB_PDB_DBI_STREAM_H_
 
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "base/logging.h"
+#include "base/memory/ref_counted.h"
 #include "syzygy/common/binary_stream.h"
 #include "syzygy/pdb/pdb_data.h"
 #include "syzygy/pdb/pdb_stream.h"
@@ -101,7 +108,12 @@ class DbiStream {
   typedef OffsetStringMap DbiEcInfoVector;
 
   // Default constructor.
-  DbiStream() {
+  DbiStream()
+      : modules_read_(false),
+        section_contribs_read_(false),
+        section_map_read_(false),
+        file_info_read_(false),
+        ec_info_read_(false) {
   }
 
   // Copy constructor.
@@ -112,7 +124,15 @@ class DbiStream {
         section_map_(other.section_map_),
         file_info_(other.file_info_),
         ec_info_vector_(other.ec_info_vector_),
-        dbg_header_(other.dbg_header_) {
+        dbg_header_(other.dbg_header_),
+        stream_(other.stream_),
+        modules_read_(other.modules_read_),
+        section_contribs_read_(other.section_contribs_read_),
+        section_map_read_(other.section_map_read_),
+        file_info_read_(other.file_info_read_),
+        ec_info_read_(other.ec_info_read_),
+        module_name_index_(other.module_name_index_),
+        section_contrib_index_(other.section_contrib_index_) {
   }
 
   // Destructor.
@@ -121,18 +141,67 @@ class DbiStream {
 
   // @name Accessors.
   // @{
+  // The substreams are only valid once they have been read, by Read or by
+  // the corresponding Read* function.
   const DbiDbgHeader& dbg_header() const { return dbg_header_; }
   const DbiHeader& header() const { return header_; }
-  const DbiModuleVector& modules() const { return modules_; }
-  const DbiSectionMap& section_map() const { return section_map_; }
+  const DbiModuleVector& modules() const {
+    DCHECK(modules_read_);
+    return modules_;
+  }
+  const DbiSectionContribVector& section_contribs() const {
+    DCHECK(section_contribs_read_);
+    return section_contribs_;
+  }
+  const DbiSectionMap& section_map() const {
+    DCHECK(section_map_read_);
+    return section_map_;
+  }
   // @}
 
-  // Reads the Dbi stream of a PDB.
+  // Reads the Dbi stream of a PDB, parsing all of its substreams.
   //
   // @param stream The stream containing the Dbi data.
   // @returns true on success, false otherwise.
   bool Read(pdb::PdbStream* stream);
 
+  // Initializes this object from the Dbi stream of a PDB, only reading its
+  // headers. The substreams are read on demand, and a reference to @p stream
+  // is kept for that purpose.
+  //
+  // @param stream The stream containing the Dbi data.
+  // @returns true on success, false otherwise.
+  bool Init(pdb::PdbStream* stream);
+
+  // @name Reads a substream of the stream passed to Init, if it hasn't been
+  //     read yet.
+  // @returns true on success, false otherwise.
+  // @{
+  bool ReadModules();
+  bool ReadSectionContribs();
+  bool ReadSectionMap();
+  bool ReadFileInfo();
+  bool ReadECInfo();
+  // @}
+
+  // Looks up a module by name, reading the module info substream if need be.
+  // If several modules have the same name, the first one is returned.
+  //
+  // @param module_name The name of the module to find.
+  // @param module_index Receives the index of the module in modules().
+  // @returns true if the module is found, false otherwise.
+  bool FindModule(const std::string& module_name, size_t* module_index);
+
+  // Finds the section contribution that contains an address, reading the
+  // section contributions substream if need be.
+  //
+  // @param section The index of the section containing the address.
+  // @param offset The offset of the address in @p section.
+  // @returns the section contribution containing the address, or nullptr if
+  //     there is none.
+  const DbiSectionContrib* FindSectionContrib(uint16_t section,
+                                              uint32_t offset);
+
  private:
   // Serialization of the Dbi header.
   //
@@ -219,6 +288,26 @@ class DbiStream {
 
   // Debug header.
   DbiDbgHeader dbg_header_;
+
+  // The stream the substreams are read from on demand. This is only set by
+  // Init.
+  scoped_refptr<pdb::PdbStream> stream_;
+
+  // @name Indicates which substreams have been read.
+  // @{
+  bool modules_read_;
+  bool section_contribs_read_;
+  bool section_map_read_;
+  bool file_info_read_;
+  bool ec_info_read_;
+  // @}
+
+  // Maps module names to their index in modules_. Built on first use.
+  std::unordered_map<std::string, size_t> module_name_index_;
+
+  // The indices of the non-empty section contributions, sorted by address.
+  // Built on first use.
+  std::vector<size_t> section_contrib_index_;
 };
 
 }  // namespace pdb
@@ -42,4 +42,65 @@ TEST(PdbDbiStreamTest, ReadInvalidDbiStream) {
   EXPECT_FALSE(dbi_stream.Read(invalid_dbi_stream.get()));
 }
 
+TEST(PdbDbiStreamTest, InitAndReadLazily) {
+  base::FilePath valid_dbi_path = testing::GetSrcRelativePath(
+      testing::kValidPdbDbiStreamPath);
+
+  scoped_refptr<pdb::PdbFileStream> valid_dbi_stream =
+      testing::GetStreamFromFile(valid_dbi_path);
+  DbiStream dbi_stream;
+  ASSERT_TRUE(dbi_stream.Read(valid_dbi_stream.get()));
+
+  DbiStream lazy_dbi_stream;
+  ASSERT_TRUE(lazy_dbi_stream.Init(valid_dbi_stream.get()));
+  EXPECT_EQ(0, ::memcmp(&dbi_stream.header(), &lazy_dbi_stream.header(),
+                        sizeof(dbi_stream.header())));
+
+  ASSERT_TRUE(lazy_dbi_stream.ReadModules());
+  ASSERT_EQ(dbi_stream.modules().size(), lazy_dbi_stream.modules().size());
+  ASSERT_FALSE(dbi_stream.modules().empty());
+
+  // Every module can be found by name, modules sharing a name map to the
+  // first of them.
+  for (size_t i = 0; i < dbi_stream.modules().size(); ++i) {
+    const std::string& name = dbi_stream.modules()[i].module_name();
+    EXPECT_EQ(name, lazy_dbi_stream.modules()[i].module_name());
+    size_t module_index = 0;
+    ASSERT_TRUE(lazy_dbi_stream.FindModule(name, &module_index));
+    EXPECT_LE(module_index, i);
+    EXPECT_EQ(name, lazy_dbi_stream.modules()[module_index].module_name());
+  }
+  size_t module_index = 0;
+  EXPECT_FALSE(lazy_dbi_stream.FindModule("no such module", &module_index));
+
+  // Every section contribution can be found by any of its addresses.
+  ASSERT_TRUE(lazy_dbi_stream.ReadSectionContribs());
+  ASSERT_EQ(dbi_stream.section_contribs().size(),
+            lazy_dbi_stream.section_contribs().size());
+  for (const DbiSectionContrib& contrib : dbi_stream.section_contribs()) {
+    if (contrib.size == 0)
+      continue;
+    uint16_t section = static_cast<uint16_t>(contrib.section);
+    uint32_t offset = static_cast<uint32_t>(contrib.offset);
+    uint32_t size = static_cast<uint32_t>(contrib.size);
+
+    const DbiSectionContrib* found =
+        lazy_dbi_stream.FindSectionContrib(section, offset);
+    ASSERT_TRUE(found != nullptr);
+    EXPECT_EQ(contrib.module, found->module);
+    EXPECT_EQ(contrib.offset, found->offset);
+
+    found = lazy_dbi_stream.FindSectionContrib(section, offset + size - 1);
+    ASSERT_TRUE(found != nullptr);
+    EXPECT_EQ(contrib.offset, found->offset);
+  }
+  EXPECT_TRUE(lazy_dbi_stream.FindSectionContrib(0xFFFF, 0) == nullptr);
+
+  EXPECT_TRUE(lazy_dbi_stream.ReadSectionMap());
+  EXPECT_EQ(dbi_stream.section_map().size(),
+            lazy_dbi_stream.section_map().size());
+  EXPECT_TRUE(lazy_dbi_stream.ReadFileInfo());
+  EXPECT_TRUE(lazy_dbi_stream.ReadECInfo());
+}
+
 }  // namespace pdb
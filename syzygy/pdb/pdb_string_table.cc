@@ -0,0 +1,265 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_string_table.h"
+
+#include <cstring>
+
+#include "base/logging.h"
+#include "syzygy/common/binary_stream.h"
+#include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_util.h"
+
+namespace pdb {
+
+namespace {
+
+// Gets the zero-terminated string at @p offset of @p strings.
+bool GetStringAt(const uint8_t* strings,
+                 size_t strings_size,
+                 size_t offset,
+                 base::StringPiece* string) {
+  DCHECK(string != NULL);
+
+  if (offset >= strings_size)
+    return false;
+
+  const char* start = reinterpret_cast<const char*>(strings + offset);
+  const void* end = ::memchr(start, 0, strings_size - offset);
+  if (end == NULL)
+    return false;
+
+  *string = base::StringPiece(start, static_cast<const char*>(end) - start);
+  return true;
+}
+
+}  // namespace
+
+const uint32_t PdbNameStreamTable::kUnusedBucket;
+const uint32_t PdbNameStreamTable::kDeletedBucket;
+
+PdbStringTable::PdbStringTable()
+    : strings_(NULL),
+      strings_size_(0),
+      buckets_(NULL),
+      bucket_count_(0),
+      string_count_(0) {
+}
+
+bool PdbStringTable::Init(PdbStream* stream,
+                          size_t table_start,
+                          size_t table_end) {
+  DCHECK(stream != NULL);
+  DCHECK_LE(table_start, table_end);
+
+  const uint8_t* data = NULL;
+  if (!GetStreamBytes(stream, table_start, table_end - table_start, &buffer_,
+                      &data)) {
+    LOG(ERROR) << "Unable to read string table.";
+    return false;
+  }
+
+  common::BinaryBufferStreamReader reader(data, table_end - table_start);
+  common::BinaryStreamParser parser(&reader);
+  uint32_t signature = 0;
+  uint32_t version = 0;
+  uint32_t strings_size = 0;
+  if (!parser.Read(&signature) || !parser.Read(&version) ||
+      !parser.Read(&strings_size)) {
+    LOG(ERROR) << "Unable to read string table header.";
+    return false;
+  }
+  if (signature != kPdbStringTableSignature ||
+      version != kPdbStringTableVersion) {
+    LOG(ERROR) << "Unexpected string table signature/version.";
+    return false;
+  }
+
+  const uint8_t* strings = data + reader.Position();
+  uint32_t bucket_count = 0;
+  if (!reader.Consume(strings_size) || !parser.Read(&bucket_count)) {
+    LOG(ERROR) << "Unable to read string table hash buckets.";
+    return false;
+  }
+
+  const uint8_t* buckets = data + reader.Position();
+  uint32_t string_count = 0;
+  if (bucket_count > (table_end - table_start) / sizeof(uint32_t) ||
+      !reader.Consume(bucket_count * sizeof(uint32_t)) ||
+      !parser.Read(&string_count) || !reader.AtEnd()) {
+    LOG(ERROR) << "String table is not valid.";
+    return false;
+  }
+
+  stream_ = stream;
+  strings_ = strings;
+  strings_size_ = strings_size;
+  buckets_ = buckets;
+  bucket_count_ = bucket_count;
+  string_count_ = string_count;
+
+  return true;
+}
+
+bool PdbStringTable::GetString(size_t offset,
+                               base::StringPiece* string) const {
+  return GetStringAt(strings_, strings_size_, offset, string);
+}
+
+bool PdbStringTable::FindString(const base::StringPiece& string,
+                                size_t* offset) const {
+  DCHECK(offset != NULL);
+
+  // The empty string lies at the start of the table, and isn't hashed.
+  if (string.empty()) {
+    *offset = 0;
+    return strings_size_ > 0 && strings_[0] == 0;
+  }
+  if (bucket_count_ == 0)
+    return false;
+
+  // The buckets are probed linearly from the hash of the string, up to an
+  // empty bucket.
+  size_t index = HashStringV1(string) % bucket_count_;
+  for (size_t i = 0; i < bucket_count_; ++i) {
+    uint32_t string_offset = GetBucket(index);
+    if (string_offset == 0)
+      return false;
+
+    base::StringPiece bucket_string;
+    if (GetString(string_offset, &bucket_string) && bucket_string == string) {
+      *offset = string_offset;
+      return true;
+    }
+
+    if (++index == bucket_count_)
+      index = 0;
+  }
+
+  return false;
+}
+
+uint32_t PdbStringTable::GetBucket(size_t index) const {
+  DCHECK_LT(index, bucket_count_);
+
+  uint32_t string_offset = 0;
+  ::memcpy(&string_offset, buckets_ + index * sizeof(string_offset),
+           sizeof(string_offset));
+  return string_offset;
+}
+
+PdbNameStreamTable::PdbNameStreamTable()
+    : strings_(NULL), strings_size_(0), entries_(NULL), size_(0) {
+  ::memset(&header_, 0, sizeof(header_));
+}
+
+bool PdbNameStreamTable::Init(PdbStream* stream) {
+  DCHECK(stream != NULL);
+
+  const uint8_t* data = NULL;
+  if (!GetStreamBytes(stream, 0, stream->length(), &buffer_, &data)) {
+    LOG(ERROR) << "Unable to read header info stream.";
+    return false;
+  }
+
+  common::BinaryBufferStreamReader reader(data, stream->length());
+  common::BinaryStreamParser parser(&reader);
+  uint32_t strings_size = 0;
+  if (!parser.Read(&header_) || !parser.Read(&strings_size)) {
+    LOG(ERROR) << "Unable to read header info stream header.";
+    return false;
+  }
+
+  const uint8_t* strings = data + reader.Position();
+  uint32_t size = 0;
+  uint32_t max = 0;
+  PdbBitSet used;
+  PdbBitSet deleted;
+  if (!reader.Consume(strings_size) || !parser.Read(&size) ||
+      !parser.Read(&max) || !used.Read(&reader) || !deleted.Read(&reader)) {
+    LOG(ERROR) << "Unable to read name-stream map header.";
+    return false;
+  }
+
+  if (max > used.size()) {
+    LOG(ERROR) << "Name-stream map bitset is too small.";
+    return false;
+  }
+
+  // The entries are stored in the order of the used buckets. Deleted buckets
+  // don't end a probe.
+  buckets_.assign(max, kUnusedBucket);
+  uint32_t entry_count = 0;
+  for (uint32_t i = 0; i < max; ++i) {
+    if (used.IsSet(i))
+      buckets_[i] = entry_count++;
+    else if (i < deleted.size() && deleted.IsSet(i))
+      buckets_[i] = kDeletedBucket;
+  }
+  if (entry_count != size) {
+    LOG(ERROR) << "Name-stream map has " << entry_count << " used buckets, "
+               << "expected " << size << ".";
+    return false;
+  }
+
+  const uint8_t* entries = data + reader.Position();
+  if (size > stream->length() / (2 * sizeof(uint32_t)) ||
+      !reader.Consume(size * 2 * sizeof(uint32_t))) {
+    LOG(ERROR) << "Unable to read name-stream map entries.";
+    return false;
+  }
+
+  stream_ = stream;
+  strings_ = strings;
+  strings_size_ = strings_size;
+  entries_ = entries;
+  size_ = size;
+
+  return true;
+}
+
+bool PdbNameStreamTable::FindStream(const base::StringPiece& name,
+                                    uint32_t* stream_id) const {
+  DCHECK(stream_id != NULL);
+
+  if (buckets_.empty())
+    return false;
+
+  // The buckets are probed linearly from the hash of the name, up to an
+  // unused bucket.
+  size_t index = HashString(name) % buckets_.size();
+  for (size_t i = 0; i < buckets_.size(); ++i) {
+    uint32_t entry = buckets_[index];
+    if (entry == kUnusedBucket)
+      return false;
+
+    if (entry != kDeletedBucket) {
+      uint32_t values[2] = {};
+      ::memcpy(values, entries_ + entry * sizeof(values), sizeof(values));
+      base::StringPiece entry_name;
+      if (GetStringAt(strings_, strings_size_, values[0], &entry_name) &&
+          entry_name == name) {
+        *stream_id = values[1];
+        return true;
+      }
+    }
+
+    if (++index == buckets_.size())
+      index = 0;
+  }
+
+  return false;
+}
+
+}  // namespace pdb
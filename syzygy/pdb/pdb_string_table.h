@@ -0,0 +1,143 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares readers for the two hashed string tables found in PDB files: the
+// string tables such as the /names stream, and the name-stream map of the
+// header info stream. Unlike ReadStringTable and ReadHeaderInfoStream, these
+// don't decode the tables up front. They look strings up through the hash
+// buckets stored in the table, and only decode the strings they touch,
+// straight from the stream's memory when it's mapped.
+
+#ifndef SYZYGY_PDB_PDB_STRING_TABLE_H_
+#define SYZYGY_PDB_PDB_STRING_TABLE_H_
+
+#include <vector>
+
+#include "base/macros.h"
+#include "base/memory/ref_counted.h"
+#include "base/strings/string_piece.h"
+#include "syzygy/pdb/pdb_data.h"
+#include "syzygy/pdb/pdb_stream.h"
+
+namespace pdb {
+
+// A string table, as found in the /names stream or in the EC info substream
+// of the Dbi stream. It holds a header, a run of zero-terminated strings, a
+// hash table of string offsets and a string count.
+class PdbStringTable {
+ public:
+  PdbStringTable();
+
+  // Initializes this table from a range of a stream. A reference to
+  // @p stream is kept for as long as this table uses its memory.
+  // @param stream the stream containing the table.
+  // @param table_start the position of the table in @p stream.
+  // @param table_end the position of the end of the table in @p stream.
+  // @returns true on success, false if the table is invalid.
+  bool Init(PdbStream* stream, size_t table_start, size_t table_end);
+
+  // Gets the string at a given offset in the table.
+  // @param offset the offset of the string, as stored in the hash table.
+  // @param string receives the string. This remains valid for the lifetime of
+  //     this table.
+  // @returns true on success, false if @p offset doesn't refer to a valid
+  //     string.
+  bool GetString(size_t offset, base::StringPiece* string) const;
+
+  // Looks up a string in the table.
+  // @param string the string to look up.
+  // @param offset receives the offset of the string.
+  // @returns true if the string is found, false otherwise.
+  bool FindString(const base::StringPiece& string, size_t* offset) const;
+
+  // @name Accessors.
+  // @{
+  size_t bucket_count() const { return bucket_count_; }
+  uint32_t string_count() const { return string_count_; }
+  // @}
+
+ private:
+  // @returns the string offset in bucket @p index.
+  uint32_t GetBucket(size_t index) const;
+
+  scoped_refptr<PdbStream> stream_;
+  std::vector<uint8_t> buffer_;
+
+  // The strings of the table.
+  const uint8_t* strings_;
+  size_t strings_size_;
+
+  // The hash buckets, each holding the offset of a string or zero.
+  const uint8_t* buckets_;
+  size_t bucket_count_;
+
+  uint32_t string_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(PdbStringTable);
+};
+
+// The name-stream map of the header info stream, mapping stream names to
+// stream IDs. See ReadHeaderInfoStream for a description of its layout.
+class PdbNameStreamTable {
+ public:
+  PdbNameStreamTable();
+
+  // Initializes this table from the header info stream. A reference to
+  // @p stream is kept for as long as this table uses its memory.
+  // @param stream the header info stream.
+  // @returns true on success, false if the stream is invalid.
+  bool Init(PdbStream* stream);
+
+  // Looks up a named stream.
+  // @param name the name of the stream.
+  // @param stream_id receives the ID of the stream.
+  // @returns true if the named stream is found, false otherwise.
+  bool FindStream(const base::StringPiece& name, uint32_t* stream_id) const;
+
+  // @name Accessors.
+  // @{
+  const PdbInfoHeader70& header() const { return header_; }
+  size_t size() const { return size_; }
+  // @}
+
+ private:
+  // @name Markers for the buckets that hold no entry.
+  // @{
+  static const uint32_t kUnusedBucket = static_cast<uint32_t>(-1);
+  static const uint32_t kDeletedBucket = static_cast<uint32_t>(-2);
+  // @}
+
+  scoped_refptr<PdbStream> stream_;
+  std::vector<uint8_t> buffer_;
+
+  PdbInfoHeader70 header_;
+
+  // The names of the streams.
+  const uint8_t* strings_;
+  size_t strings_size_;
+
+  // The {string offset, stream ID} pairs, in bucket order.
+  const uint8_t* entries_;
+  size_t size_;
+
+  // The index in entries_ of the entry in each bucket, or one of the markers
+  // above.
+  std::vector<uint32_t> buckets_;
+
+  DISALLOW_COPY_AND_ASSIGN(PdbNameStreamTable);
+};
+
+}  // namespace pdb
+
+#endif  // SYZYGY_PDB_PDB_STRING_TABLE_H_
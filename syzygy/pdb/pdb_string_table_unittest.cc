@@ -0,0 +1,162 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pdb/pdb_string_table.h"
+
+#include "base/strings/stringprintf.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/pdb/pdb_byte_stream.h"
+#include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_reader.h"
+#include "syzygy/pdb/pdb_util.h"
+#include "syzygy/pdb/unittest_util.h"
+
+namespace pdb {
+
+namespace {
+
+// Checks that every string of @p string_map can be found in @p table.
+void ExpectStringsFound(const OffsetStringMap& string_map,
+                        const PdbStringTable& table) {
+  for (const auto& entry : string_map) {
+    base::StringPiece string;
+    ASSERT_TRUE(table.GetString(entry.first, &string));
+    EXPECT_EQ(entry.second, string.as_string());
+
+    // Strings may be present several times, in which case any of them will
+    // do.
+    size_t offset = 0;
+    ASSERT_TRUE(table.FindString(entry.second, &offset));
+    ASSERT_TRUE(table.GetString(offset, &string));
+    EXPECT_EQ(entry.second, string.as_string());
+  }
+
+  size_t offset = 0;
+  EXPECT_FALSE(table.FindString("this string is not in the table", &offset));
+}
+
+}  // namespace
+
+TEST(PdbStringTableTest, FindNamesStreamStrings) {
+  PdbReader reader;
+  PdbFile pdb_file;
+  ASSERT_TRUE(reader.Read(
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath), &pdb_file));
+
+  PdbInfoHeader70 header = {};
+  NameStreamMap name_stream_map;
+  ASSERT_TRUE(ReadHeaderInfoStream(pdb_file, &header, &name_stream_map));
+  ASSERT_TRUE(name_stream_map.find("/names") != name_stream_map.end());
+  scoped_refptr<PdbStream> names_stream =
+      pdb_file.GetStream(name_stream_map["/names"]);
+  ASSERT_TRUE(names_stream.get() != NULL);
+
+  OffsetStringMap string_map;
+  ASSERT_TRUE(ReadStringTable(names_stream.get(), "/names", 0,
+                              names_stream->length(), &string_map));
+  ASSERT_FALSE(string_map.empty());
+
+  PdbStringTable table;
+  ASSERT_TRUE(table.Init(names_stream.get(), 0, names_stream->length()));
+  ASSERT_NO_FATAL_FAILURE(ExpectStringsFound(string_map, table));
+
+  // The same, from a byte stream which is read in place.
+  scoped_refptr<PdbByteStream> byte_stream(new PdbByteStream());
+  ASSERT_TRUE(byte_stream->Init(names_stream.get()));
+  PdbStringTable byte_table;
+  ASSERT_TRUE(byte_table.Init(byte_stream.get(), 0, byte_stream->length()));
+  ASSERT_NO_FATAL_FAILURE(ExpectStringsFound(string_map, byte_table));
+}
+
+TEST(PdbStringTableTest, InitFailsOnInvalidTable) {
+  scoped_refptr<PdbByteStream> stream(new PdbByteStream());
+  scoped_refptr<WritablePdbStream> writer = stream->GetWritableStream();
+  writer->Write(kPdbStringTableSignature);
+  writer->Write(kPdbStringTableVersion);
+
+  // Missing size.
+  PdbStringTable table;
+  EXPECT_FALSE(table.Init(stream.get(), 0, stream->length()));
+
+  // Buckets exceeding the table.
+  writer->Write(static_cast<uint32_t>(1));  // String size.
+  writer->Write(static_cast<uint8_t>(0));   // Empty string.
+  writer->Write(static_cast<uint32_t>(4));  // Bucket count.
+  writer->Write(static_cast<uint32_t>(0));  // Bucket.
+  EXPECT_FALSE(table.Init(stream.get(), 0, stream->length()));
+
+  // The valid table holds the empty string alone.
+  writer->Write(static_cast<uint32_t>(0));  // Bucket.
+  writer->Write(static_cast<uint32_t>(0));  // Bucket.
+  writer->Write(static_cast<uint32_t>(0));  // Bucket.
+  writer->Write(static_cast<uint32_t>(0));  // String count.
+  ASSERT_TRUE(table.Init(stream.get(), 0, stream->length()));
+  size_t offset = 1;
+  EXPECT_TRUE(table.FindString("", &offset));
+  EXPECT_EQ(0u, offset);
+  EXPECT_FALSE(table.FindString("foo", &offset));
+}
+
+TEST(PdbNameStreamTableTest, FindPdbNamedStreams) {
+  PdbReader reader;
+  PdbFile pdb_file;
+  ASSERT_TRUE(reader.Read(
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath), &pdb_file));
+
+  PdbInfoHeader70 header = {};
+  NameStreamMap name_stream_map;
+  ASSERT_TRUE(ReadHeaderInfoStream(pdb_file, &header, &name_stream_map));
+  ASSERT_FALSE(name_stream_map.empty());
+
+  PdbNameStreamTable table;
+  ASSERT_TRUE(table.Init(pdb_file.GetStream(kPdbHeaderInfoStream).get()));
+  EXPECT_EQ(0, ::memcmp(&header, &table.header(), sizeof(header)));
+  EXPECT_EQ(name_stream_map.size(), table.size());
+  for (const auto& entry : name_stream_map) {
+    uint32_t stream_id = 0;
+    EXPECT_TRUE(table.FindStream(entry.first, &stream_id));
+    EXPECT_EQ(entry.second, stream_id);
+  }
+
+  uint32_t stream_id = 0;
+  EXPECT_FALSE(table.FindStream("/no/such/stream", &stream_id));
+}
+
+TEST(PdbNameStreamTableTest, FindWrittenNamedStreams) {
+  // Write enough names for the hash buckets to collide.
+  PdbInfoHeader70 header = {};
+  header.version = kPdbCurrentVersion;
+  NameStreamMap name_stream_map;
+  for (uint32_t i = 0; i < 100; ++i)
+    name_stream_map[base::StringPrintf("/stream/%d", i)] = i + 10;
+
+  scoped_refptr<PdbByteStream> stream(new PdbByteStream());
+  ASSERT_TRUE(WriteHeaderInfoStream(header, name_stream_map,
+                                    stream->GetWritableStream().get()));
+
+  PdbNameStreamTable table;
+  ASSERT_TRUE(table.Init(stream.get()));
+  EXPECT_EQ(name_stream_map.size(), table.size());
+  for (const auto& entry : name_stream_map) {
+    uint32_t stream_id = 0;
+    EXPECT_TRUE(table.FindStream(entry.first, &stream_id));
+    EXPECT_EQ(entry.second, stream_id);
+  }
+
+  uint32_t stream_id = 0;
+  EXPECT_FALSE(table.FindStream("/stream/100", &stream_id));
+}
+
+}  // namespace pdb
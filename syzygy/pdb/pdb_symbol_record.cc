@@ -15,6 +15,7 @@
 #include "syzygy/pdb/pdb_symbol_record.h"
 
 #include <string>
+#include <vector>
 
 #include "base/strings/stringprintf.h"
 #include "syzygy/common/align.h"
@@ -27,6 +28,8 @@ namespace cci = Microsoft_Cci_Pdb;
 
 namespace pdb {
 
+const size_t kSymbolBatchSize = 256;
+
 bool ReadSymbolRecord(PdbStream* stream,
                       size_t symbol_table_offset,
                       size_t symbol_table_size,
@@ -160,4 +163,90 @@ bool VisitSymbols(VisitSymbolsCallback callback,
   return true;
 }
 
+bool VisitSymbolBatches(VisitSymbolBatchesCallback callback,
+                        size_t symbol_table_offset,
+                        size_t symbol_table_size,
+                        bool has_header,
+                        PdbStream* symbols) {
+  DCHECK(symbols != NULL);
+
+  if (symbol_table_offset > symbols->length() ||
+      symbol_table_size > symbols->length() - symbol_table_offset) {
+    LOG(ERROR) << "Symbol table size provided exceeds stream length.";
+    return false;
+  }
+  if (has_header && symbol_table_size < sizeof(uint32_t)) {
+    LOG(ERROR) << "Unable to read symbol stream type.";
+    return false;
+  }
+  if (symbol_table_size == 0)
+    return true;
+
+  // Use the stream's own memory if it holds the table contiguously, or else
+  // read the table once.
+  const uint8_t* table = nullptr;
+  std::vector<uint8_t> buffer;
+  if (!GetStreamBytes(symbols, symbol_table_offset, symbol_table_size, &buffer,
+                      &table)) {
+    LOG(ERROR) << "Unable to read symbol table.";
+    return false;
+  }
+
+  size_t pos = 0;
+  if (has_header) {
+    uint32_t stream_type = 0;
+    ::memcpy(&stream_type, table, sizeof(stream_type));
+    if (stream_type != cci::C13) {
+      LOG(ERROR) << "Unexpected symbol stream type (" << stream_type
+                 << ").";
+      return false;
+    }
+    pos += sizeof(stream_type);
+  }
+
+  std::vector<SymbolRecordView> batch;
+  batch.reserve(kSymbolBatchSize);
+  while (pos < symbol_table_size) {
+    uint16_t symbol_length = 0;
+    if (symbol_table_size - pos < sizeof(symbol_length)) {
+      LOG(ERROR) << "Unable to read symbol length from symbol stream.";
+      return false;
+    }
+    ::memcpy(&symbol_length, table + pos, sizeof(symbol_length));
+    pos += sizeof(symbol_length);
+
+    // We can see empty symbols in the symbol stream.
+    if (symbol_length == 0)
+      continue;
+
+    SymbolRecordView symbol = {};
+    if (symbol_length < sizeof(symbol.type)) {
+      LOG(ERROR) << "Symbol length too short to hold symbol type.";
+      return false;
+    }
+    if (symbol_length > symbol_table_size - pos) {
+      LOG(ERROR) << "Encountered symbol length that exceeds table size.";
+      return false;
+    }
+
+    ::memcpy(&symbol.type, table + pos, sizeof(symbol.type));
+    symbol.length =
+        static_cast<uint16_t>(symbol_length - sizeof(symbol.type));
+    symbol.data = table + pos + sizeof(symbol.type);
+    pos += symbol_length;
+
+    batch.push_back(symbol);
+    if (batch.size() == kSymbolBatchSize) {
+      if (!callback.Run(batch.data(), batch.size()))
+        return false;
+      batch.clear();
+    }
+  }
+
+  if (!batch.empty() && !callback.Run(batch.data(), batch.size()))
+    return false;
+
+  return true;
+}
+
 }  // namespace pdb
@@ -14,6 +14,11 @@
 //
 // This file allows reading the content of the symbol record table from a PDB
 // stream.
+//
+// VisitSymbols hands each symbol to its callback through a stream reader.
+// VisitSymbolBatches instead decodes the records straight from memory and
+// hands them out in arrays of views, which is much cheaper for consumers that
+// scan large symbol streams.
 
 #ifndef SYZYGY_PDB_PDB_SYMBOL_RECORD_H_
 #define SYZYGY_PDB_PDB_SYMBOL_RECORD_H_
@@ -65,6 +70,46 @@ bool VisitSymbols(VisitSymbolsCallback callback,
                   bool has_header,
                   PdbStream* symbols);
 
+// A symbol record decoded in place by VisitSymbolBatches.
+struct SymbolRecordView {
+  // The type of the symbol.
+  uint16_t type;
+  // The length of the symbol data, exclusive of the type.
+  uint16_t length;
+  // The symbol data. This is only valid for the duration of the callback.
+  const uint8_t* data;
+};
+
+// The maximum number of symbols handed to a VisitSymbolBatchesCallback at
+// once.
+extern const size_t kSymbolBatchSize;
+
+// Defines a symbol batch visitor callback. This receives consecutive symbols
+// of the visited table, in order, and needs to return true to continue the
+// visit and false to terminate it.
+typedef base::Callback<bool(const SymbolRecordView* /* symbols */,
+                            size_t /* symbol_count */)>
+    VisitSymbolBatchesCallback;
+
+// Reads symbols from the given symbol stream until the end of the table,
+// handing them to @p callback in batches of up to kSymbolBatchSize. The
+// symbols are decoded in place when @p symbols holds the table contiguously in
+// memory, as a byte stream or a mapped stream does, and from a single copy of
+// the table otherwise. Empty symbols are skipped.
+// @param callback The callback to be invoked for each batch of symbols.
+// @param symbol_table_offset The start offset of the symbol table to visit.
+// @param symbol_table_size The size of the symbol record table.
+// @param has_header If true then this will first parse the symbol stream
+//     header and ensure it is of the expected type. If false it will assume
+//     it is the expected type and start parsing symbols immediately.
+// @param symbols The stream containing symbols to be visited.
+// @returns true on success, false otherwise.
+bool VisitSymbolBatches(VisitSymbolBatchesCallback callback,
+                        size_t symbol_table_offset,
+                        size_t symbol_table_size,
+                        bool has_header,
+                        PdbStream* symbols);
+
 }  // namespace pdb
 
 #endif  // SYZYGY_PDB_PDB_SYMBOL_RECORD_H_
@@ -14,6 +14,9 @@
 
 #include "syzygy/pdb/pdb_symbol_record.h"
 
+#include <utility>
+#include <vector>
+
 #include "base/bind.h"
 #include "base/files/file_util.h"
 #include "gmock/gmock.h"
@@ -50,6 +53,40 @@ class MockVisitorImpl {
 };
 typedef testing::StrictMock<MockVisitorImpl> MockVisitor;
 
+// A symbol type and length, as seen by a visitor.
+typedef std::pair<uint16_t, uint16_t> VisitedSymbol;
+
+bool VisitSymbol(std::vector<VisitedSymbol>* visited,
+                 uint16_t symbol_length,
+                 uint16_t symbol_type,
+                 common::BinaryStreamReader* reader) {
+  visited->push_back(std::make_pair(symbol_type, symbol_length));
+  return true;
+}
+
+bool VisitSymbolBatch(std::vector<VisitedSymbol>* visited,
+                      size_t* batch_count,
+                      const SymbolRecordView* symbols,
+                      size_t symbol_count) {
+  EXPECT_LT(0u, symbol_count);
+  EXPECT_GE(kSymbolBatchSize, symbol_count);
+  ++*batch_count;
+  for (size_t i = 0; i < symbol_count; ++i)
+    visited->push_back(std::make_pair(symbols[i].type, symbols[i].length));
+  return true;
+}
+
+bool StopAtFirstSymbolBatch(std::vector<VisitedSymbol>* visited,
+                            size_t* batch_count,
+                            const SymbolRecordView* symbols,
+                            size_t symbol_count) {
+  VisitSymbolBatch(visited, batch_count, symbols, symbol_count);
+  uint32_t data = 0;
+  ::memcpy(&data, symbols[0].data, sizeof(data));
+  EXPECT_EQ(0x12345678u, data);
+  return false;
+}
+
 }  // namespace
 
 #if 0
@@ -215,4 +252,80 @@ TEST_F(PdbVisitSymbolsTest, AllSymbolsVisitedNoHeader) {
   EXPECT_TRUE(VisitSymbols(callback, 0, reader->length(), false, reader.get()));
 }
 
+TEST_F(PdbVisitSymbolsTest, BatchesFailOnInvalidStreams) {
+  SetUpByteStream();
+  std::vector<VisitedSymbol> visited;
+  size_t batch_count = 0;
+  VisitSymbolBatchesCallback callback = base::Bind(
+      &VisitSymbolBatch, base::Unretained(&visited),
+      base::Unretained(&batch_count));
+
+  // Missing stream type.
+  EXPECT_FALSE(
+      VisitSymbolBatches(callback, 0, reader->length(), true, reader.get()));
+
+  // Table size exceeding the stream.
+  writer->Write(static_cast<uint32_t>(cci::C13));  // Symbol stream type.
+  EXPECT_FALSE(VisitSymbolBatches(callback, 0, 2 * reader->length(), true,
+                                  reader.get()));
+
+  // Short symbol length.
+  writer->Write(static_cast<uint16_t>(1));  // Symbol length.
+  EXPECT_FALSE(
+      VisitSymbolBatches(callback, 0, reader->length(), true, reader.get()));
+  EXPECT_EQ(0u, batch_count);
+}
+
+TEST_F(PdbVisitSymbolsTest, BatchesEarlyTermination) {
+  SetUpByteStream();
+  writer->Write(static_cast<uint32_t>(cci::C13));  // Symbol stream type.
+  writer->Write(static_cast<uint16_t>(0));         // Empty symbol.
+  writer->Write(static_cast<uint16_t>(6));         // Symbol length.
+  writer->Write(static_cast<uint16_t>(0x2937));    // Made up symbol type.
+  writer->Write(static_cast<uint32_t>(0x12345678));  // Dummy data.
+
+  std::vector<VisitedSymbol> visited;
+  size_t batch_count = 0;
+  VisitSymbolBatchesCallback callback = base::Bind(
+      &StopAtFirstSymbolBatch, base::Unretained(&visited),
+      base::Unretained(&batch_count));
+  EXPECT_FALSE(
+      VisitSymbolBatches(callback, 0, reader->length(), true, reader.get()));
+  EXPECT_EQ(1u, batch_count);
+  ASSERT_EQ(1u, visited.size());
+  EXPECT_EQ(VisitedSymbol(0x2937, 4), visited[0]);
+}
+
+TEST_F(PdbVisitSymbolsTest, AllSymbolsVisitedInBatches) {
+  base::FilePath valid_sym_record_path = testing::GetSrcRelativePath(
+      testing::kValidPdbSymbolRecordStreamPath);
+
+  // Visit the symbols from a file stream, which is copied, and from a byte
+  // stream, which is decoded in place.
+  scoped_refptr<PdbStream> file_stream =
+      testing::GetStreamFromFile(valid_sym_record_path);
+  scoped_refptr<PdbByteStream> byte_stream(new PdbByteStream());
+  ASSERT_TRUE(byte_stream->Init(file_stream.get()));
+
+  std::vector<VisitedSymbol> expected;
+  ASSERT_TRUE(VisitSymbols(
+      base::Bind(&VisitSymbol, base::Unretained(&expected)), 0,
+      file_stream->length(), false, file_stream.get()));
+  // There are 697 symbols in the sample symbol stream in test_data.
+  EXPECT_EQ(697u, expected.size());
+
+  for (PdbStream* stream : {file_stream.get(),
+                            static_cast<PdbStream*>(byte_stream.get())}) {
+    std::vector<VisitedSymbol> visited;
+    size_t batch_count = 0;
+    EXPECT_TRUE(VisitSymbolBatches(
+        base::Bind(&VisitSymbolBatch, base::Unretained(&visited),
+                   base::Unretained(&batch_count)),
+        0, stream->length(), false, stream));
+    EXPECT_EQ(expected, visited);
+    EXPECT_EQ((expected.size() + kSymbolBatchSize - 1) / kSymbolBatchSize,
+              batch_count);
+  }
+}
+
 }  // namespace pdb
@@ -14,6 +14,8 @@
 
 #include "syzygy/pdb/pdb_type_info_stream_enum.h"
 
+#include <algorithm>
+
 #include "base/strings/stringprintf.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_util.h"
@@ -69,12 +71,63 @@ bool TypeInfoEnumerator::Init() {
   type_id_min_ = type_info_header_.type_min;
   type_id_max_ = type_info_header_.type_max;
 
+  // Every record holds at least its length and its type.
+  if (type_id_max_ < type_id_min_ ||
+      type_id_max_ - type_id_min_ >
+          type_info_header_.type_info_data_size / (2 * sizeof(uint16_t))) {
+    LOG(ERROR) << "The type info stream has an invalid type index range.";
+    return false;
+  }
+  located_records_.assign(type_id_max_ - type_id_min_, TypeRecordInfo());
+  type_index_offsets_.clear();
+  record_cache_.clear();
+  record_cache_lru_.clear();
+
   largest_located_id_ = type_id_min_ - 1;
   // Locate the first type info record - note that this may fail if the
   // stream is invalid or empty.
   return EnsureTypeLocated(type_id_min_);
 }
 
+bool TypeInfoEnumerator::InitTypeIndexOffsets(PdbStream* hash_stream) {
+  DCHECK(stream_ != nullptr);
+  DCHECK(hash_stream != nullptr);
+
+  type_index_offsets_.clear();
+
+  const OffsetCb& buffer =
+      type_info_header_.type_info_hash.offset_cb_type_info_offset;
+  if (buffer.cb % sizeof(TypeIndexOffset) != 0 ||
+      buffer.offset > hash_stream->length() ||
+      buffer.cb > hash_stream->length() - buffer.offset) {
+    LOG(ERROR) << "Invalid type index offset buffer.";
+    return false;
+  }
+
+  std::vector<TypeIndexOffset> offsets(buffer.cb / sizeof(TypeIndexOffset));
+  if (!offsets.empty() &&
+      !hash_stream->ReadBytesAt(buffer.offset, buffer.cb, &offsets.at(0))) {
+    LOG(ERROR) << "Unable to read the type index offset buffer.";
+    return false;
+  }
+
+  // The samples are only usable if they're strictly ordered and point inside
+  // the type records, as a bad sample would silently locate the wrong record.
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    if (offsets[i].type_id < type_id_min_ ||
+        offsets[i].type_id >= type_id_max_ ||
+        offsets[i].offset >= type_info_header_.type_info_data_size ||
+        (i > 0 && (offsets[i].type_id <= offsets[i - 1].type_id ||
+                   offsets[i].offset <= offsets[i - 1].offset))) {
+      LOG(ERROR) << "Malformed type index offset buffer.";
+      return false;
+    }
+  }
+
+  type_index_offsets_.swap(offsets);
+  return true;
+}
+
 bool TypeInfoEnumerator::NextTypeInfoRecord() {
   DCHECK(stream_ != nullptr);
 
@@ -111,7 +164,10 @@ bool TypeInfoEnumerator::ResetStream() {
 
 TypeInfoEnumerator::BinaryTypeRecordReader
 TypeInfoEnumerator::CreateRecordReader() {
-  return BinaryTypeRecordReader(start_position(), len(), stream_.get());
+  scoped_refptr<PdbByteStream> body = GetCurrentRecordBody();
+  if (body.get() == nullptr)
+    return BinaryTypeRecordReader(start_position(), len(), stream_.get());
+  return BinaryTypeRecordReader(0, body->length(), body.get());
 }
 
 bool TypeInfoEnumerator::EnsureTypeLocated(uint32_t type_id) {
@@ -119,24 +175,66 @@ bool TypeInfoEnumerator::EnsureTypeLocated(uint32_t type_id) {
 
   if (type_id >= type_id_max_ || type_id < type_id_min_)
     return false;
-  if (type_id <= largest_located_id_)
+  if (IsRecordLocated(type_id))
     return true;
 
-#ifndef NDEBUG
-  if (type_id > type_id_min_) {
-    TypeRecordInfo info = {};
-    bool found = FindRecordInfo(largest_located_id_, &info);
-    DCHECK(found);
-    DCHECK_EQ(info.start + info.length + sizeof(info.length),
-              reader_.Position());
+  // By default scan on from the end of the run of located records at the
+  // start of the stream.
+  uint32_t start_id = largest_located_id_ + 1;
+  size_t start_position = type_info_header_.len;
+  if (largest_located_id_ >= type_id_min_) {
+    const TypeRecordInfo& last =
+        located_records_[largest_located_id_ - type_id_min_];
+    start_position = last.start + sizeof(last.length) + last.length;
   }
-#endif
 
-  uint32_t current_type_id = largest_located_id_;
-  common::BinaryStreamParser parser(&reader_);
-  while (current_type_id < type_id) {
+  // Jump to the closest sampled record if it's further along.
+  if (!type_index_offsets_.empty()) {
+    auto it = std::upper_bound(
+        type_index_offsets_.begin(), type_index_offsets_.end(), type_id,
+        [](uint32_t id, const TypeIndexOffset& sample) {
+          return id < sample.type_id;
+        });
+    if (it != type_index_offsets_.begin()) {
+      --it;
+      if (it->type_id > start_id) {
+        start_id = it->type_id;
+        start_position = type_info_header_.len + it->offset;
+      }
+    }
+  }
+
+  // Records between the starting point and the target may have been located
+  // by an earlier seek, in which case the scan can start after the closest.
+  for (uint32_t id = type_id; id > start_id; --id) {
+    if (IsRecordLocated(id - 1)) {
+      const TypeRecordInfo& info = located_records_[id - 1 - type_id_min_];
+      start_id = id;
+      start_position = info.start + sizeof(info.length) + info.length;
+      break;
+    }
+  }
+
+  return LocateRecords(start_id, start_position, type_id);
+}
+
+bool TypeInfoEnumerator::LocateRecords(uint32_t type_id,
+                                       size_t position,
+                                       uint32_t last_type_id) {
+  DCHECK_LE(type_id, last_type_id);
+
+  if (position > data_end_) {
+    LOG(ERROR) << "Type info record lies outside of the stream.";
+    return false;
+  }
+
+  PdbStreamReaderWithPosition reader(position, data_end_ - position,
+                                     stream_.get());
+  common::BinaryStreamParser parser(&reader);
+  for (uint32_t current_type_id = type_id; current_type_id <= last_type_id;
+       ++current_type_id) {
     TypeRecordInfo next_info = {};
-    next_info.start = reader_.Position();
+    next_info.start = position + reader.Position();
     if (!parser.Read(&next_info.length)) {
       LOG(ERROR) << "Unable to read a type info record length.";
       return false;
@@ -145,17 +243,16 @@ bool TypeInfoEnumerator::EnsureTypeLocated(uint32_t type_id) {
       LOG(ERROR) << "Unable to read a type info record type.";
       return false;
     }
-    if (!reader_.Consume(next_info.length - sizeof(next_info.type))) {
+    if (!reader.Consume(next_info.length - sizeof(next_info.type))) {
       LOG(ERROR) << "Unable to consume type body.";
       return false;
     }
 
-    ++current_type_id;
     bool added = AddRecordInfo(current_type_id, next_info);
     DCHECK(added);
   }
 
-  return type_id == current_type_id;
+  return true;
 }
 
 bool TypeInfoEnumerator::AddRecordInfo(uint32_t type_id,
@@ -163,11 +260,18 @@ bool TypeInfoEnumerator::AddRecordInfo(uint32_t type_id,
   if (type_id >= type_id_max_ || type_id < type_id_min_)
     return false;
 
-  DCHECK_EQ(largest_located_id_ + 1, type_id);
-  DCHECK_EQ(located_records_.size(), largest_located_id_ - type_id_min_ + 1);
+  DCHECK_NE(0u, info.start);
+  located_records_[type_id - type_id_min_] = info;
 
-  located_records_.push_back(info);
-  largest_located_id_ = type_id;
+  // Extend the run of located records at the start of the stream, which may
+  // now join up with records located by earlier seeks.
+  if (type_id == largest_located_id_ + 1) {
+    largest_located_id_ = type_id;
+    while (largest_located_id_ + 1 < type_id_max_ &&
+           IsRecordLocated(largest_located_id_ + 1)) {
+      ++largest_located_id_;
+    }
+  }
 
   return true;
 }
@@ -175,14 +279,42 @@ bool TypeInfoEnumerator::AddRecordInfo(uint32_t type_id,
 bool TypeInfoEnumerator::FindRecordInfo(uint32_t type_id,
                                         TypeRecordInfo* info) {
   DCHECK(info);
-  if (type_id >= type_id_max_ || type_id < type_id_min_)
+  if (!IsRecordLocated(type_id))
     return false;
 
-  DCHECK_GT(located_records_.size(), type_id - type_id_min_);
   *info = located_records_[type_id - type_id_min_];
   return true;
 }
 
+bool TypeInfoEnumerator::IsRecordLocated(uint32_t type_id) const {
+  if (type_id >= type_id_max_ || type_id < type_id_min_)
+    return false;
+  return located_records_[type_id - type_id_min_].start != 0;
+}
+
+scoped_refptr<PdbByteStream> TypeInfoEnumerator::GetCurrentRecordBody() {
+  auto it = record_cache_.find(type_id_);
+  if (it != record_cache_.end()) {
+    record_cache_lru_.splice(record_cache_lru_.begin(), record_cache_lru_,
+                             it->second.lru_position);
+    return it->second.body;
+  }
+
+  scoped_refptr<PdbByteStream> body(new PdbByteStream());
+  if (!body->Init(stream_.get(), start_position(), len()))
+    return nullptr;
+
+  if (record_cache_.size() >= kMaxCachedRecords) {
+    record_cache_.erase(record_cache_lru_.back());
+    record_cache_lru_.pop_back();
+  }
+  record_cache_lru_.push_front(type_id_);
+  CachedRecord cached = {body, record_cache_lru_.begin()};
+  record_cache_[type_id_] = cached;
+
+  return body;
+}
+
 TypeInfoEnumerator::BinaryTypeRecordReader::BinaryTypeRecordReader(
     size_t start_offset,
     size_t len,
@@ -18,8 +18,10 @@
 #define SYZYGY_PDB_PDB_TYPE_INFO_STREAM_ENUM_H_
 
 #include <stdint.h>
+#include <list>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "base/callback.h"
 #include "base/memory/ref_counted.h"
@@ -45,6 +47,18 @@ class TypeInfoEnumerator {
   // @returns true on success, false means bad header format.
   bool Init();
 
+  // Loads the type index offset buffer from the type info hash stream. This
+  // is a sorted sample of (type index, record offset) pairs, which lets
+  // SeekRecord jump to the closest sampled record and scan forward from
+  // there instead of from the start of the stream. Optional; without it every
+  // seek ahead of the records located so far scans the stream sequentially.
+  // @param hash_stream the stream numbered type_info_header().type_info_hash.
+  //     stream_number.
+  // @returns true on success, false if the buffer can't be read or is
+  //     malformed, in which case seeking keeps scanning sequentially.
+  // @pre Init has succeeded.
+  bool InitTypeIndexOffsets(PdbStream* hash_stream);
+
   // Moves to the next record in the type info stream. Expects stream position
   // at the beginning of a type info record.
   // @returns true on success, false on failure.
@@ -64,7 +78,8 @@ class TypeInfoEnumerator {
   bool ResetStream();
 
   // Creates and returns a class that implements common::BinaryStreamReader
-  // over the current record.
+  // over the current record. The bodies of the most recently read records are
+  // cached in memory, so re-reading a record doesn't touch the stream.
   BinaryTypeRecordReader CreateRecordReader();
 
   // @name Accessors.
@@ -107,13 +122,37 @@ class TypeInfoEnumerator {
     uint16_t length;
   };
 
+  // A sampled type record location from the type index offset buffer.
+  struct TypeIndexOffset {
+    uint32_t type_id;
+    // The offset of the record relative to the end of the header.
+    uint32_t offset;
+  };
+
+  // A cached record body, and its position in the recently used list.
+  struct CachedRecord {
+    scoped_refptr<PdbByteStream> body;
+    std::list<uint32_t>::iterator lru_position;
+  };
+
+  // The maximum number of record bodies kept by CreateRecordReader.
+  static const size_t kMaxCachedRecords = 1024;
+
   // Ensure that the type with ID @p type_id has been located and stored
   // in @p located_records_.
   bool EnsureTypeLocated(uint32_t type_id);
-  // Adds the start position @p position for @p type_id, which must be a valid
-  // type id, and must be one larger than the last added start position.
+  // Scans the records from @p type_id at stream position @p position up to
+  // and including @p last_type_id, storing their locations.
+  bool LocateRecords(uint32_t type_id, size_t position, uint32_t last_type_id);
+  // Adds the location @p record for @p type_id, which must be a valid
+  // type id.
   bool AddRecordInfo(uint32_t type_id, const TypeRecordInfo& record);
   bool FindRecordInfo(uint32_t type_id, TypeRecordInfo* record);
+  // @returns true if the record @p type_id has already been located.
+  bool IsRecordLocated(uint32_t type_id) const;
+  // Gets the cached body of the current record, reading it if necessary.
+  // @returns the body, or nullptr if it can't be read.
+  scoped_refptr<PdbByteStream> GetCurrentRecordBody();
 
   // Pointer to the PDB type info stream.
   scoped_refptr<PdbStream> stream_;
@@ -124,12 +163,24 @@ class TypeInfoEnumerator {
   // Header of the type info stream.
   TypeInfoHeader type_info_header_;
 
-  // A vector with the positions of located records.
+  // A vector with the positions of records, indexed by type ID less
+  // type_id_min_. Records that haven't been located yet have a start of 0,
+  // which is inside the header.
   std::vector<TypeRecordInfo> located_records_;
 
-  // The largest type index we already saved in @p located_records_.
+  // All type indices up to and including this one are in
+  // @p located_records_.
   uint32_t largest_located_id_;
 
+  // The type index offset buffer, sorted by type ID. Empty if it wasn't
+  // loaded.
+  std::vector<TypeIndexOffset> type_index_offsets_;
+
+  // The record bodies cached by CreateRecordReader, by type ID, and the
+  // cached type IDs, from most to least recently used.
+  std::unordered_map<uint32_t, CachedRecord> record_cache_;
+  std::list<uint32_t> record_cache_lru_;
+
   // Position of the end of data in the stream.
   size_t data_end_;
 
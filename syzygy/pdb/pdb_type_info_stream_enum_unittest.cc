@@ -17,6 +17,9 @@
 #include "base/files/file_util.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_file.h"
+#include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/unittest_util.h"
 
 namespace pdb {
@@ -163,6 +166,80 @@ TEST(PdbTypeInfoStreamEnumTest, ReadValidTypeInfoStreamWithReader) {
   EXPECT_EQ(kTestRecord + kOffset, enumerator.type_id());
 }
 
+TEST(PdbTypeInfoStreamEnumTest, SeekRecordWithTypeIndexOffsets) {
+  PdbReader reader;
+  PdbFile pdb_file;
+  ASSERT_TRUE(reader.Read(
+      testing::GetSrcRelativePath(testing::kTestPdbFilePath), &pdb_file));
+  scoped_refptr<PdbStream> tpi_stream = pdb_file.GetStream(kTpiStream);
+  ASSERT_TRUE(tpi_stream.get() != nullptr);
+
+  // A sequential enumerator is the reference for the indexed one.
+  TypeInfoEnumerator sequential(tpi_stream.get());
+  ASSERT_TRUE(sequential.Init());
+
+  TypeInfoEnumerator indexed(tpi_stream.get());
+  ASSERT_TRUE(indexed.Init());
+  scoped_refptr<PdbStream> hash_stream = pdb_file.GetStream(
+      indexed.type_info_header().type_info_hash.stream_number);
+  ASSERT_TRUE(hash_stream.get() != nullptr);
+  ASSERT_TRUE(indexed.InitTypeIndexOffsets(hash_stream.get()));
+
+  const uint32_t kMinIndex = indexed.type_info_header().type_min;
+  const uint32_t kMaxIndex = indexed.type_info_header().type_max;
+  EXPECT_FALSE(indexed.SeekRecord(kMaxIndex));
+
+  // Seek backwards through the stream, so that the indexed enumerator can't
+  // rely on the records it has already located.
+  for (int64_t type_id = kMaxIndex - 1; type_id >= kMinIndex; type_id -= 97) {
+    ASSERT_TRUE(indexed.SeekRecord(static_cast<uint32_t>(type_id)));
+    ASSERT_TRUE(sequential.SeekRecord(static_cast<uint32_t>(type_id)));
+    EXPECT_EQ(sequential.start_position(), indexed.start_position());
+    EXPECT_EQ(sequential.type(), indexed.type());
+    EXPECT_EQ(sequential.len(), indexed.len());
+  }
+
+  // Enumerating on from a seek still works.
+  ASSERT_TRUE(indexed.SeekRecord((kMinIndex + kMaxIndex) / 2));
+  ASSERT_TRUE(sequential.SeekRecord((kMinIndex + kMaxIndex) / 2));
+  while (!indexed.EndOfStream()) {
+    ASSERT_TRUE(indexed.NextTypeInfoRecord());
+    ASSERT_TRUE(sequential.NextTypeInfoRecord());
+    EXPECT_EQ(sequential.start_position(), indexed.start_position());
+  }
+}
+
+TEST(PdbTypeInfoStreamEnumTest, CachedRecordReaderMatchesStream) {
+  base::FilePath valid_type_info_path =
+      testing::GetSrcRelativePath(testing::kValidPdbTypeInfoStreamPath);
+
+  scoped_refptr<pdb::PdbFileStream> valid_type_info_stream =
+      testing::GetStreamFromFile(valid_type_info_path);
+
+  TypeInfoEnumerator enumerator(valid_type_info_stream.get());
+  ASSERT_TRUE(enumerator.Init());
+
+  // Read every record twice, the second time through the cache, and compare
+  // with the bytes in the stream.
+  while (!enumerator.EndOfStream()) {
+    ASSERT_TRUE(enumerator.NextTypeInfoRecord());
+    std::vector<uint8_t> expected(enumerator.len());
+    if (expected.empty())
+      continue;
+    ASSERT_TRUE(valid_type_info_stream->ReadBytesAt(
+        enumerator.start_position(), expected.size(), &expected.at(0)));
+
+    for (size_t i = 0; i < 2; ++i) {
+      TypeInfoEnumerator::BinaryTypeRecordReader reader(
+          enumerator.CreateRecordReader());
+      std::vector<uint8_t> data(expected.size());
+      ASSERT_TRUE(reader.Read(data.size(), &data.at(0)));
+      EXPECT_TRUE(reader.AtEnd());
+      EXPECT_EQ(expected, data);
+    }
+  }
+}
+
 TEST(PdbTypeInfoStreamEnumTest, EnumInvalidDataTypeInfoStream) {
   base::FilePath invalid_type_info_path =
       testing::GetSrcRelativePath(testing::kInvalidDataPdbTypeInfoStreamPath);
@@ -22,6 +22,7 @@
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_stream_reader.h"
+#include "syzygy/pdb/pdb_string_table.h"
 #include "syzygy/pdb/pdb_writer.h"
 
 namespace pdb {
@@ -241,6 +242,10 @@ bool PdbBitSet::IsEmpty() const {
 }
 
 uint16_t HashString(const base::StringPiece& string) {
+  return HashStringV1(string) & 0xFFFF;
+}
+
+uint32_t HashStringV1(const base::StringPiece& string) {
   size_t length = string.size();
   const char* data = string.data();
 
@@ -264,7 +269,35 @@ uint16_t HashString(const base::StringPiece& string) {
   hash ^= hash >> 11;
   hash ^= hash >> 16;
 
-  return hash & 0xFFFF;
+  return hash;
+}
+
+bool GetStreamBytes(PdbStream* stream,
+                    size_t pos,
+                    size_t count,
+                    std::vector<uint8_t>* buffer,
+                    const uint8_t** data) {
+  DCHECK(stream != NULL);
+  DCHECK(buffer != NULL);
+  DCHECK(data != NULL);
+
+  if (pos > stream->length() || count > stream->length() - pos)
+    return false;
+
+  std::vector<PdbStream::View> views;
+  if (count > 0 && stream->GetViews(pos, count, &views) &&
+      views.size() == 1) {
+    DCHECK_EQ(count, views[0].size);
+    *data = views[0].data;
+    return true;
+  }
+
+  buffer->resize(count);
+  if (count > 0 && !stream->ReadBytesAt(pos, count, buffer->data()))
+    return false;
+  *data = buffer->data();
+
+  return true;
 }
 
 uint32_t GetDbiDbgHeaderOffset(const DbiHeader& dbi_header) {
@@ -400,16 +433,13 @@ bool ReadPdbHeader(const base::FilePath& pdb_path,
   DCHECK(!pdb_path.empty());
   DCHECK(pdb_header != NULL);
 
+  // Only the header stream is read, as this is used to probe candidate PDB
+  // files while searching for the one matching a module.
   PdbReader pdb_reader;
-  PdbFile pdb_file;
-  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
-    LOG(ERROR) << "Unable to process PDB file: " << pdb_path.value();
-    return false;
-  }
-
-  PdbStream* header_stream = pdb_file.GetStream(kPdbHeaderInfoStream).get();
-  if (header_stream == NULL) {
-    LOG(ERROR) << "PDB file contains no header stream: " << pdb_path.value();
+  scoped_refptr<PdbStream> header_stream;
+  if (!pdb_reader.ReadStream(pdb_path, kPdbHeaderInfoStream, &header_stream)) {
+    LOG(ERROR) << "Unable to read header stream of PDB file: "
+               << pdb_path.value();
     return false;
   }
 
@@ -779,24 +809,23 @@ bool LoadNamedStreamFromPdbFile(
   DCHECK(stream != NULL);
   DCHECK(stream->get() == NULL);
 
-  // Get the PDB header and try to get the named stream ID from it.
-  pdb::PdbInfoHeader70 pdb_header = {0};
-  pdb::NameStreamMap name_stream_map;
-  if (!ReadHeaderInfoStream(
-          pdb_file->GetStream(pdb::kPdbHeaderInfoStream).get(), &pdb_header,
-          &name_stream_map)) {
+  // Look up the named stream ID in the name-stream map of the header.
+  scoped_refptr<PdbStream> header_stream =
+      pdb_file->GetStream(pdb::kPdbHeaderInfoStream);
+  PdbNameStreamTable name_stream_table;
+  if (header_stream.get() == NULL ||
+      !name_stream_table.Init(header_stream.get())) {
     LOG(ERROR) << "Failed to read header info stream.";
     return false;
   }
 
   // The stream with the given name does not exist.
-  pdb::NameStreamMap::const_iterator name_it = name_stream_map.find(
-      stream_name.as_string());
-  if (name_it == name_stream_map.end())
+  uint32_t stream_id = 0;
+  if (!name_stream_table.FindStream(stream_name, &stream_id))
     return true;
 
   // Get the named stream and ensure that it's not empty.
-  *stream = pdb_file->GetStream(name_it->second);
+  *stream = pdb_file->GetStream(stream_id);
   if (stream->get() == NULL) {
     LOG(ERROR) << "Failed to read the \"" << stream_name.as_string()
                << "\" stream from the PDB.";
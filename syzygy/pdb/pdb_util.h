@@ -83,6 +83,29 @@ class PdbBitSet {
 // @returns the hashed string.
 uint16_t HashString(const base::StringPiece& string);
 
+// Calculates the full 32-bit hash value of a string, of which HashString is
+// the low 16 bits. This is the hash used by the buckets of version 1 string
+// tables, such as the /names stream.
+// @param string the string to hash.
+// @returns the hashed string.
+uint32_t HashStringV1(const base::StringPiece& string);
+
+// Gets a pointer to a range of bytes of a stream. This points into the
+// stream's own memory if it holds the range contiguously, as byte streams and
+// mapped streams do, and to a copy of the range otherwise.
+// @param stream the stream to read.
+// @param pos the position of the range in @p stream.
+// @param count the number of bytes in the range.
+// @param buffer receives the copy of the range if one is needed.
+// @param data receives a pointer to the range. This remains valid as long as
+//     @p stream and @p buffer do.
+// @returns true on success, false if the range can't be read.
+bool GetStreamBytes(PdbStream* stream,
+                    size_t pos,
+                    size_t count,
+                    std::vector<uint8_t>* buffer,
+                    const uint8_t** data);
+
 // Get the DbiDbgHeader offset within the Dbi info stream. For some reason,
 // the EC info data comes before the Dbi debug header despite that the Dbi
 // debug header size comes before the EC info size in the Dbi header struct.
@@ -118,7 +141,8 @@ bool SetOmapFromStream(const std::vector<OMAP>& omap_from_list,
 // @returns true on success, false otherwise.
 bool SetGuid(const GUID& guid, PdbFile* pdb_file);
 
-// Reads the header from the given PDB file @p pdb_path.
+// Reads the header from the given PDB file @p pdb_path. Only the header info
+// stream is read, so this is cheap enough to probe many candidate files.
 // @param pdb_path the path to the PDB whose header is to be read.
 // @param pdb_header the header to be filled in.
 // @returns true on success, false otherwise.
@@ -15,6 +15,8 @@
 #include "syzygy/pdbfind/pdbfind_app.h"
 
 #include "base/files/file_util.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/sys_info.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/pe/pdb_info.h"
 #include "syzygy/pe/pe_file.h"
@@ -29,12 +31,15 @@ const int kError = 1;
 const int kUnableToFindPdb = 2;
 const int kMissingOrMalformedCodeViewRecord = 3;
 
+const char kJobsSwitch[] = "jobs";
+const char kFindCacheSwitch[] = "find-cache";
+
 const char kUsageFormatStr[] =
-    "Usage: %ls <input-image-path>\n"
+    "Usage: %ls [options] <input-image-path> [<input-image-path> ...]\n"
     "\n"
-    "  Searches for the PDB file matching the provided image. If successfully\n"
-    "  found prints the absolute path to stdout and exit with a return code\n"
-    "  of 0.\n"
+    "  Searches for the PDB file matching each of the provided images. If\n"
+    "  successfully found prints the absolute path to stdout and exit with a\n"
+    "  return code of 0. One line is output per image, in order.\n"
     "\n"
     "  On any error (invalid command line, missing image file) exits with an\n"
     "  error message and exits with a return code of 1.\n"
@@ -44,7 +49,17 @@ const char kUsageFormatStr[] =
     "  2.\n"
     "\n"
     "  If the image does not contain a CodeView record or it is malformed\n"
-    "  exits with a return code of 3.\n"
+    "  outputs an empty line and exits with a return code of 3.\n"
+    "\n"
+    "  When several images fail the return code is the lowest non-zero one.\n"
+    "\n"
+    "Options:\n"
+    "  --jobs=<n>           The number of images to search for at once.\n"
+    "                       Defaults to the number of processors.\n"
+    "  --find-cache=<path>  A file caching the locations of the PDB files\n"
+    "                       found. It is read if it exists, and updated once\n"
+    "                       the search is done, so that later runs needn't\n"
+    "                       search for them again.\n"
     "\n";
 
 }  // namespace
@@ -59,47 +74,94 @@ bool PdbFindApp::ParseCommandLine(const base::CommandLine* cmd_line) {
   if (args.size() == 0)
     return Usage(cmd_line, "Must specify input-image-path.");
 
-  if (args.size() > 1)
-    return Usage(cmd_line, "Can specify only one input-image-path.");
+  input_image_paths_.clear();
+  for (size_t i = 0; i < args.size(); ++i)
+    input_image_paths_.push_back(base::FilePath(args[i]));
+
+  jobs_ = base::SysInfo::NumberOfProcessors();
+  if (cmd_line->HasSwitch(kJobsSwitch)) {
+    std::string jobs = cmd_line->GetSwitchValueASCII(kJobsSwitch);
+    unsigned value = 0;
+    if (!base::StringToUint(jobs, &value) || value == 0)
+      return Usage(cmd_line, "The number of jobs must be a positive integer.");
+    jobs_ = value;
+  }
 
-  input_image_path_ = base::FilePath(args[0]);
+  find_cache_path_ = cmd_line->GetSwitchValuePath(kFindCacheSwitch);
 
   return true;
 }
 
 int PdbFindApp::Run() {
-  if (!base::PathExists(input_image_path_)) {
-    LOG(ERROR) << "File not found: " << input_image_path_.value();
-    return kError;
+  DCHECK_LT(0U, jobs_);
+
+  // Check every image up front, so that the search below only covers images
+  // with a CodeView record.
+  std::vector<pe::PdbInfo> pdb_infos(input_image_paths_.size());
+  std::vector<bool> has_codeview(input_image_paths_.size(), false);
+  std::vector<base::FilePath> module_paths;
+  int result = kSuccess;
+  for (size_t i = 0; i < input_image_paths_.size(); ++i) {
+    const base::FilePath& image_path = input_image_paths_[i];
+    if (!base::PathExists(image_path)) {
+      LOG(ERROR) << "File not found: " << image_path.value();
+      return kError;
+    }
+
+    pe::PEFile pe_file;
+    if (!pe_file.Init(image_path)) {
+      LOG(ERROR) << "Failed to parse PE file: " << image_path.value();
+      return kError;
+    }
+
+    // Malformed or missing CodeView record.
+    if (!pdb_infos[i].Init(pe_file)) {
+      result = kMissingOrMalformedCodeViewRecord;
+      continue;
+    }
+    has_codeview[i] = true;
+    module_paths.push_back(image_path);
   }
 
-  pe::PEFile pe_file;
-  if (!pe_file.Init(input_image_path_)) {
-    LOG(ERROR) << "Failed to parse PE file: " << input_image_path_.value();
+  if (!find_cache_path_.empty() &&
+      !pe::FindCache::Get()->Load(find_cache_path_)) {
     return kError;
   }
 
-  // Malformed or missing CodeView record.
-  pe::PdbInfo pdb_info;
-  if (!pdb_info.Init(pe_file))
-    return kMissingOrMalformedCodeViewRecord;
-
-  // Look for the matching PDB.
-  base::FilePath pdb_path;
-  if (!pe::FindPdbForModule(input_image_path_, &pdb_path)) {
+  // Look for the matching PDBs.
+  std::vector<base::FilePath> pdb_paths;
+  if (!pe::FindPdbsForModules(module_paths, jobs_, &pdb_paths)) {
     LOG(ERROR) << "Error searching for PDB file.";
     return kError;
   }
+  DCHECK_EQ(module_paths.size(), pdb_paths.size());
+
+  // A cache that can't be updated only costs later runs some time.
+  if (!find_cache_path_.empty() &&
+      !pe::FindCache::Get()->Save(find_cache_path_)) {
+    LOG(WARNING) << "Failed to update find cache.";
+  }
 
-  // Not found? Then output the path where we expected to find it and indicate
-  // that it could not be found.
-  if (pdb_path.empty()) {
-    fprintf(out(), "%ls\n", pdb_info.pdb_file_name().value().c_str());
-    return kUnableToFindPdb;
+  size_t pdb_index = 0;
+  for (size_t i = 0; i < input_image_paths_.size(); ++i) {
+    if (!has_codeview[i]) {
+      fprintf(out(), "\n");
+      continue;
+    }
+
+    // Not found? Then output the path where we expected to find it and
+    // indicate that it could not be found.
+    const base::FilePath& pdb_path = pdb_paths[pdb_index++];
+    if (pdb_path.empty()) {
+      fprintf(out(), "%ls\n", pdb_infos[i].pdb_file_name().value().c_str());
+      result = kUnableToFindPdb;
+      continue;
+    }
+
+    fprintf(out(), "%ls\n", pdb_path.value().c_str());
   }
 
-  fprintf(out(), "%ls\n", pdb_path.value().c_str());
-  return kSuccess;
+  return result;
 }
 
 bool PdbFindApp::Usage(const base::CommandLine* cmd_line,
@@ -13,13 +13,16 @@
 // limitations under the License.
 //
 // Defines the PdbFindApp class, which implements a command-line tool for
-// finding the PDB file associated with a given PE file. This uses the same
+// finding the PDB files associated with given PE files. This uses the same
 // search mechanism as that employed by the decomposer but outputs meaningful
-// return code and easily parsable output.
+// return code and easily parsable output. Several images are searched for
+// concurrently.
 
 #ifndef SYZYGY_PDBFIND_PDBFIND_APP_H_
 #define SYZYGY_PDBFIND_PDBFIND_APP_H_
 
+#include <vector>
+
 #include "base/command_line.h"
 #include "base/files/file_path.h"
 #include "syzygy/application/application.h"
@@ -33,7 +36,7 @@ namespace pdbfind {
 class PdbFindApp : public application::AppImplBase {
  public:
   PdbFindApp()
-      : application::AppImplBase("PdbFind") {
+      : application::AppImplBase("PdbFind"), jobs_(0) {
   }
 
   // @name Implementation of the AppImplBase interface.
@@ -51,7 +54,9 @@ class PdbFindApp : public application::AppImplBase {
 
   // @name Command-line parameters.
   // @{
-  base::FilePath input_image_path_;
+  std::vector<base::FilePath> input_image_paths_;
+  size_t jobs_;
+  base::FilePath find_cache_path_;
   // @}
 };
 
@@ -15,6 +15,7 @@
 #include "syzygy/pdbfind/pdbfind_app.h"
 
 #include "base/files/file_util.h"
+#include "base/strings/string_split.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
@@ -29,7 +30,9 @@ namespace {
 
 class TestPdbFindApp : public PdbFindApp {
  public:
-  using PdbFindApp::input_image_path_;
+  using PdbFindApp::input_image_paths_;
+  using PdbFindApp::jobs_;
+  using PdbFindApp::find_cache_path_;
 };
 
 typedef application::Application<TestPdbFindApp> TestApp;
@@ -96,16 +99,32 @@ TEST_F(PdbFindAppTest, EmptyCommandLineFails) {
   ASSERT_FALSE(app_impl_.ParseCommandLine(&cmd_line_));
 }
 
-TEST_F(PdbFindAppTest, TooManyArgumentsFails) {
+TEST_F(PdbFindAppTest, ParseWithOneArgumentPasses) {
   cmd_line_.AppendArg("foo.dll");
-  cmd_line_.AppendArg("bar.dll");
-  ASSERT_FALSE(app_impl_.ParseCommandLine(&cmd_line_));
+  ASSERT_TRUE(app_impl_.ParseCommandLine(&cmd_line_));
+  ASSERT_EQ(1u, app_impl_.input_image_paths_.size());
+  EXPECT_EQ(base::FilePath(L"foo.dll"), app_impl_.input_image_paths_[0]);
+  EXPECT_LT(0u, app_impl_.jobs_);
+  EXPECT_TRUE(app_impl_.find_cache_path_.empty());
 }
 
-TEST_F(PdbFindAppTest, ParseWithOneArgumentPasses) {
+TEST_F(PdbFindAppTest, ParseWithSeveralArgumentsPasses) {
   cmd_line_.AppendArg("foo.dll");
+  cmd_line_.AppendArg("bar.dll");
+  cmd_line_.AppendSwitchASCII("jobs", "3");
+  cmd_line_.AppendSwitchPath("find-cache", base::FilePath(L"cache.json"));
   ASSERT_TRUE(app_impl_.ParseCommandLine(&cmd_line_));
-  EXPECT_EQ(app_impl_.input_image_path_, base::FilePath(L"foo.dll"));
+  ASSERT_EQ(2u, app_impl_.input_image_paths_.size());
+  EXPECT_EQ(base::FilePath(L"foo.dll"), app_impl_.input_image_paths_[0]);
+  EXPECT_EQ(base::FilePath(L"bar.dll"), app_impl_.input_image_paths_[1]);
+  EXPECT_EQ(3u, app_impl_.jobs_);
+  EXPECT_EQ(base::FilePath(L"cache.json"), app_impl_.find_cache_path_);
+}
+
+TEST_F(PdbFindAppTest, ParseWithInvalidJobsFails) {
+  cmd_line_.AppendArg("foo.dll");
+  cmd_line_.AppendSwitchASCII("jobs", "0");
+  ASSERT_FALSE(app_impl_.ParseCommandLine(&cmd_line_));
 }
 
 TEST_F(PdbFindAppTest, ModuleNotFound) {
@@ -150,4 +169,26 @@ TEST_F(PdbFindAppTest, Succeeds) {
 #endif
 }
 
+TEST_F(PdbFindAppTest, SucceedsForSeveralImages) {
+  base::FilePath test_dll = testing::GetExeRelativePath(testing::kTestDllName);
+  base::FilePath find_cache = temp_dir_.Append(L"find_cache.json");
+  cmd_line_.AppendArgPath(test_dll);
+  cmd_line_.AppendArgPath(test_dll);
+  cmd_line_.AppendSwitchASCII("jobs", "2");
+  cmd_line_.AppendSwitchPath("find-cache", find_cache);
+  ASSERT_EQ(0, app_.Run());
+
+  // The search results were saved.
+  EXPECT_TRUE(base::PathExists(find_cache));
+
+  TearDownStreams();
+  std::string actual_stdout;
+  ASSERT_TRUE(base::ReadFileToString(stdout_path_, &actual_stdout));
+  std::vector<std::string> lines = base::SplitString(
+      actual_stdout, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  ASSERT_EQ(2u, lines.size());
+  EXPECT_EQ(lines[0], lines[1]);
+  EXPECT_TRUE(base::PathExists(base::FilePath(base::ASCIIToUTF16(lines[0]))));
+}
+
 }  // namespace pdbfind
@@ -14,8 +14,12 @@
 
 #include "syzygy/pe/coff_decomposer.h"
 
+#include <algorithm>
+
+#include "base/atomicops.h"
 #include "base/auto_reset.h"
 #include "base/strings/string_split.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/block_graph/typed_block.h"
 #include "syzygy/common/align.h"
 #include "syzygy/pe/cvinfo_ext.h"
@@ -47,6 +51,12 @@ const char kRelocsBlockName[] = "<relocs>";
 
 const size_t kDebugSubsectionAlignment = 4;
 
+// The number of sections a worker thread resolves the relocations of at a
+// time. With function-level linking most sections hold a single function,
+// so handing them out one by one would have the threads spend their time
+// contending for the next one.
+const size_t kSectionsPerWorkItem = 16;
+
 // Retrieve the relocation type and size for the specified COFF relocation.
 //
 // @param reloc the relocation.
@@ -107,7 +117,7 @@ bool GetRelocationTypeAndSize(const IMAGE_RELOCATION& reloc,
 // @param extra_offset where to place the additional offset read.
 // @returns true on success, or false on failure.
 template <typename ValueType>
-bool ReadRelocationValue(Block* source,
+bool ReadRelocationValue(const Block* source,
                          BlockGraph::Offset src_offset,
                          BlockGraph::Offset* extra_offset) {
   ConstTypedBlock<ValueType> value;
@@ -429,8 +439,58 @@ bool ParseDebugSubsections2(Block* block) {
 
 const char CoffDecomposer::kSectionComdatSep[] = "; COMDAT=";
 
+// The work shared by the worker threads resolving relocations. Each run
+// resolves the relocations of the next slice of sections that no thread has
+// claimed yet, into the references of those sections.
+class CoffDecomposer::RelocationWork
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  RelocationWork(const CoffDecomposer* decomposer,
+                 std::vector<PendingReferences>* references)
+      : decomposer_(decomposer),
+        references_(references),
+        next_index_(0),
+        failed_(0) {
+    DCHECK(decomposer != NULL);
+    DCHECK(references != NULL);
+  }
+
+  // @returns the number of work items needed to cover all of the sections.
+  size_t work_items() const {
+    return (references_->size() + kSectionsPerWorkItem - 1) /
+        kSectionsPerWorkItem;
+  }
+
+  // @returns true if the relocations of any section failed to be resolved.
+  bool failed() const { return base::subtle::Acquire_Load(&failed_) != 0; }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, work_items());
+    size_t begin = index * kSectionsPerWorkItem;
+    size_t end = std::min(begin + kSectionsPerWorkItem, references_->size());
+    for (size_t i = begin; i < end && !failed(); ++i) {
+      if (!decomposer_->ResolveSectionRelocations(i, &(*references_)[i]))
+        base::subtle::Release_Store(&failed_, 1);
+    }
+  }
+  // @}
+
+ private:
+  const CoffDecomposer* decomposer_;
+  std::vector<PendingReferences>* references_;
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(RelocationWork);
+};
+
 CoffDecomposer::CoffDecomposer(const CoffFile& image_file)
     : image_file_(image_file),
+      num_threads_(1),
       image_layout_(NULL),
       image_(NULL) {
 }
@@ -815,9 +875,49 @@ bool CoffDecomposer::CreateReferencesFromDebugInfo() {
 bool CoffDecomposer::CreateReferencesFromRelocations() {
   DCHECK(image_ != NULL);
 
+  // The relocations of each section are resolved separately, possibly
+  // concurrently, then the references are added to the block graph in order.
+  size_t num_sections = image_file_.file_header()->NumberOfSections;
+  std::vector<PendingReferences> references(num_sections);
+  RelocationWork work(this, &references);
+  size_t work_items = work.work_items();
+  if (num_threads_ <= 1 || work_items <= 1) {
+    for (size_t i = 0; i < work_items && !work.failed(); ++i)
+      work.Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "CoffDecomposer",
+        static_cast<int>(std::min(num_threads_, work_items)));
+    pool.Start();
+    pool.AddWork(&work, static_cast<int>(work_items));
+    pool.JoinAll();
+  }
+  if (work.failed())
+    return false;
+
+  for (size_t i = 0; i < num_sections; ++i) {
+    for (size_t j = 0; j < references[i].size(); ++j) {
+      if (!AddReference(references[i][j]))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool CoffDecomposer::ResolveSectionRelocations(
+    size_t section_index, PendingReferences* references) const {
+  DCHECK(image_ != NULL);
+  DCHECK(references != NULL);
+
   CoffFile::RelocMap reloc_map;
-  image_file_.DecodeRelocs(&reloc_map);
+  if (!image_file_.DecodeSectionRelocs(section_index, &reloc_map)) {
+    LOG(ERROR) << "Unable to decode relocations of section " << section_index
+               << ".";
+    return false;
+  }
 
+  references->reserve(reloc_map.size());
   CoffFile::RelocMap::iterator it = reloc_map.begin();
   for (; it != reloc_map.end(); ++it) {
     DCHECK(it->second != NULL);
@@ -833,12 +933,14 @@ bool CoffDecomposer::CreateReferencesFromRelocations() {
     DCHECK_LT(ref_type, BlockGraph::REFERENCE_TYPE_MAX);
     DCHECK_GT(ref_size, 0u);
 
-    // Add reference.
+    // Resolve reference.
     size_t offset = symbol->SectionNumber == 0 ? 0 : symbol->Value;
-    if (!CreateSymbolOffsetReference(it->first, ref_type, ref_size,
-                                     symbol, offset)) {
+    PendingReference reference = {};
+    if (!ResolveSymbolOffsetReference(it->first, ref_type, ref_size,
+                                      symbol, offset, &reference)) {
       return false;
     }
+    references->push_back(reference);
   }
 
   return true;
@@ -955,7 +1057,20 @@ bool CoffDecomposer::CreateReference(FileOffsetAddress src_addr,
                                      BlockGraph::Size ref_size,
                                      Block* target,
                                      BlockGraph::Offset offset) {
+  PendingReference reference = {};
+  return ResolveReference(src_addr, ref_type, ref_size, target, offset,
+                          &reference) &&
+      AddReference(reference);
+}
+
+bool CoffDecomposer::ResolveReference(FileOffsetAddress src_addr,
+                                      ReferenceType ref_type,
+                                      BlockGraph::Size ref_size,
+                                      Block* target,
+                                      BlockGraph::Offset offset,
+                                      PendingReference* reference) const {
   DCHECK(image_ != NULL);
+  DCHECK(reference != NULL);
 
   // Get source block and offset.
   Block* source = NULL;
@@ -987,18 +1102,28 @@ bool CoffDecomposer::CreateReference(FileOffsetAddress src_addr,
     }
   }
 
+  reference->source = source;
+  reference->src_offset = src_offset;
+  reference->ref =
+      Reference(ref_type, ref_size, target, offset + extra_offset, offset);
+  return true;
+}
+
+bool CoffDecomposer::AddReference(const PendingReference& reference) {
+  Block* source = reference.source;
+  DCHECK(source != NULL);
+
   // Find an existing reference, or insert a new one.
-  Reference ref(ref_type, ref_size, target, offset + extra_offset, offset);
   Block::ReferenceMap::const_iterator ref_it =
-      source->references().find(src_offset);
+      source->references().find(reference.src_offset);
   if (ref_it == source->references().end()) {
     // New reference.
-    CHECK(source->SetReference(src_offset, ref));
+    CHECK(source->SetReference(reference.src_offset, reference.ref));
   } else {
     // Collisions are only allowed if the references are identical.
-    if (!(ref == ref_it->second)) {
+    if (!(reference.ref == ref_it->second)) {
       LOG(ERROR) << "Block \"" << source->name() << "\" has a conflicting "
-                 << "reference at offset " << src_offset << ".";
+                 << "reference at offset " << reference.src_offset << ".";
       return false;
     }
   }
@@ -1056,32 +1181,57 @@ bool CoffDecomposer::CreateSymbolOffsetReference(FileOffsetAddress src_addr,
                                                  BlockGraph::Size ref_size,
                                                  const IMAGE_SYMBOL* symbol,
                                                  size_t offset) {
+  PendingReference reference = {};
+  return ResolveSymbolOffsetReference(src_addr, ref_type, ref_size, symbol,
+                                      offset, &reference) &&
+      AddReference(reference);
+}
+
+bool CoffDecomposer::ResolveSymbolOffsetReference(
+    FileOffsetAddress src_addr,
+    ReferenceType ref_type,
+    BlockGraph::Size ref_size,
+    const IMAGE_SYMBOL* symbol,
+    size_t offset,
+    PendingReference* reference) const {
   DCHECK(image_ != NULL);
   DCHECK(symbol != NULL);
+  DCHECK(reference != NULL);
 
   if (symbol->SectionNumber < 0) {
     LOG(ERROR) << "Symbol cannot be converted to a reference.";
     return false;
   }
 
+  // Get target block and offset.
+  Block* target = NULL;
+  BlockGraph::Offset target_offset = -1;
   if (symbol->SectionNumber != 0) {
     // Section symbol.
-    return CreateSectionOffsetReference(src_addr, ref_type, ref_size,
-                                        symbol->SectionNumber - 1, offset);
+    if (!SectionOffsetToBlockOffset(symbol->SectionNumber - 1, offset,
+                                    &target, &target_offset)) {
+      return false;
+    }
   } else {
     // External symbol. As a convention, we use a reference to the symbol
     // table, since there is no corresponding block. The offset is ignored
     // (will be inferred from the symbol value and reference type).
     size_t symbol_index = symbol - image_file_.symbols();
-    return CreateFileOffsetReference(
-        src_addr, ref_type, ref_size,
+    FileOffsetAddress symbol_addr(
         image_file_.symbols_address() + symbol_index * sizeof(*symbol));
+    if (!FileOffsetToBlockOffset(symbol_addr, &target, &target_offset))
+      return false;
   }
+  DCHECK(target != NULL);
+  DCHECK_GE(target_offset, 0);
+
+  return ResolveReference(src_addr, ref_type, ref_size, target, target_offset,
+                          reference);
 }
 
 bool CoffDecomposer::FileOffsetToBlockOffset(FileOffsetAddress addr,
                                              Block** block,
-                                             BlockGraph::Offset* offset) {
+                                             BlockGraph::Offset* offset) const {
   DCHECK(image_ != NULL);
   DCHECK(block != NULL);
   DCHECK(offset != NULL);
@@ -1101,10 +1251,11 @@ bool CoffDecomposer::FileOffsetToBlockOffset(FileOffsetAddress addr,
   return true;
 }
 
-bool CoffDecomposer::SectionOffsetToBlockOffset(size_t section_index,
-                                                size_t section_offset,
-                                                Block** block,
-                                                BlockGraph::Offset* offset) {
+bool CoffDecomposer::SectionOffsetToBlockOffset(
+    size_t section_index,
+    size_t section_offset,
+    Block** block,
+    BlockGraph::Offset* offset) const {
   DCHECK(image_ != NULL);
   DCHECK_NE(BlockGraph::kInvalidSectionId, section_index);
   DCHECK_LT(section_index, image_file_.file_header()->NumberOfSections);
@@ -1114,7 +1265,7 @@ bool CoffDecomposer::SectionOffsetToBlockOffset(size_t section_index,
   DCHECK(offset != NULL);
 
   // Get block and offset.
-  SectionBlockMap::iterator it = section_block_map_.find(section_index);
+  SectionBlockMap::const_iterator it = section_block_map_.find(section_index);
   if (it == section_block_map_.end()) {
     LOG(ERROR) << "Section " << section_index << " is not mapped to a block.";
     return false;
@@ -1128,7 +1279,7 @@ bool CoffDecomposer::SectionOffsetToBlockOffset(size_t section_index,
 }
 
 CoffDecomposer::BlockGraphAddress CoffDecomposer::FileOffsetToBlockGraphAddress(
-    FileOffsetAddress addr) {
+    FileOffsetAddress addr) const {
   return BlockGraphAddress(addr.value());
 }
 
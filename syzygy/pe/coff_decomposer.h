@@ -72,6 +72,7 @@
 
 #include <windows.h>  // NOLINT
 #include <map>
+#include <vector>
 
 #include "syzygy/pe/coff_file.h"
 #include "syzygy/pe/image_layout.h"
@@ -112,15 +113,40 @@ class CoffDecomposer {
   // and image layout are equal to the file offsets of the COFF file.
   bool Decompose(ImageLayout* image_layout);
 
+  // @name Accessors and mutators.
+  // @{
+  // The number of threads on which the relocations of the sections are
+  // resolved to references. Defaults to 1, which does all of the work on the
+  // calling thread.
+  size_t num_threads() const { return num_threads_; }
+  void set_num_threads(size_t num_threads) {
+    DCHECK_LT(0u, num_threads);
+    num_threads_ = num_threads;
+  }
+  // @}
+
  private:
   typedef block_graph::BlockGraph BlockGraph;
   typedef core::FileOffsetAddress FileOffsetAddress;
   typedef core::RelativeAddress BlockGraphAddress;
 
+  // Resolves the relocations of sections on worker threads. Defined in the
+  // implementation.
+  class RelocationWork;
+
   // A map from section indexes to the corresponding block in the
   // block graph.
   typedef std::map<size_t, BlockGraph::Block*> SectionBlockMap;
 
+  // A reference that has been resolved, but not yet added to its source
+  // block.
+  struct PendingReference {
+    BlockGraph::Block* source;
+    BlockGraph::Offset src_offset;
+    BlockGraph::Reference ref;
+  };
+  typedef std::vector<PendingReference> PendingReferences;
+
   // @name Decomposition steps.
   // @{
   // Add non-section contents as blocks with associated references in the
@@ -176,6 +202,16 @@ class CoffDecomposer {
   // @returns true on success, false on failure.
   bool CreateReferencesFromDebugInfo();
 
+  // Resolve the relocations of a section to references, without adding them
+  // to the block graph. This only reads the block graph, so it may be called
+  // concurrently for distinct sections.
+  //
+  // @param section_index the index of the section.
+  // @param references where to append the resolved references.
+  // @returns true on success, false on failure.
+  bool ResolveSectionRelocations(size_t section_index,
+                                 PendingReferences* references) const;
+
   // Add jump and case table labels to code blocks, based on STATIC entries
   // present in the COFF symbol table.
   //
@@ -213,6 +249,25 @@ class CoffDecomposer {
                        BlockGraph::Block* target,
                        BlockGraph::Offset offset);
 
+  // Resolve a reference as specified, without adding it to its source block.
+  // The parameters are as for CreateReference.
+  //
+  // @param reference where to store the resolved reference.
+  // @returns true on success, false on failure.
+  bool ResolveReference(FileOffsetAddress src_addr,
+                        BlockGraph::ReferenceType ref_type,
+                        BlockGraph::Size ref_size,
+                        BlockGraph::Block* target,
+                        BlockGraph::Offset offset,
+                        PendingReference* reference) const;
+
+  // Add a resolved reference to its source block, ignoring any existing
+  // identical reference at the same source offset.
+  //
+  // @param reference the reference to add.
+  // @returns true on success, false on failure.
+  bool AddReference(const PendingReference& reference);
+
   // Create a reference to the specified file offset, ignoring any existing
   // identical reference at the same source offset.
   //
@@ -265,6 +320,18 @@ class CoffDecomposer {
                                    const IMAGE_SYMBOL* symbol,
                                    size_t offset);
 
+  // Resolve a reference to the specified symbol, without adding it to its
+  // source block. The parameters are as for CreateSymbolOffsetReference.
+  //
+  // @param reference where to store the resolved reference.
+  // @returns true on success, false on failure.
+  bool ResolveSymbolOffsetReference(FileOffsetAddress src_addr,
+                                    BlockGraph::ReferenceType ref_type,
+                                    BlockGraph::Size ref_size,
+                                    const IMAGE_SYMBOL* symbol,
+                                    size_t offset,
+                                    PendingReference* reference) const;
+
   // Translate a file offset to a block and offset within that block.
   // Translated offsets are always positive or zero and fall within
   // the boundaries of the block.
@@ -276,7 +343,7 @@ class CoffDecomposer {
   //     contents of the output arguments is unspecified.
   bool FileOffsetToBlockOffset(FileOffsetAddress addr,
                                BlockGraph::Block** block,
-                               BlockGraph::Offset* offset);
+                               BlockGraph::Offset* offset) const;
 
   // Translate a section index and offset to a block and offset within that
   // block. Translated offsets are always positive or zero and fall within
@@ -290,7 +357,7 @@ class CoffDecomposer {
   //     contents of the output arguments is unspecified.
   bool SectionOffsetToBlockOffset(size_t section_index, size_t section_offset,
                                   BlockGraph::Block** block,
-                                  BlockGraph::Offset* offset);
+                                  BlockGraph::Offset* offset) const;
 
   // Convert a file offset to a relative address suitable for use in the
   // block graph and associated structures. The values of the address
@@ -298,7 +365,8 @@ class CoffDecomposer {
   //
   // @param addr the file offset to translate.
   // @returns a relative address with the same value as the file offset.
-  BlockGraphAddress FileOffsetToBlockGraphAddress(FileOffsetAddress addr);
+  BlockGraphAddress FileOffsetToBlockGraphAddress(
+      FileOffsetAddress addr) const;
 
   // The CoffFile that is being decomposed.
   const CoffFile& image_file_;
@@ -307,6 +375,9 @@ class CoffDecomposer {
   // graph.
   SectionBlockMap section_block_map_;
 
+  // The number of threads resolving relocations.
+  size_t num_threads_;
+
   // @name Temporaries that are only valid while inside of Decompose().
   // @{
   // The image layout we are building.
@@ -176,6 +176,51 @@ TEST_F(CoffDecomposerTest, Decompose) {
   EXPECT_EQ(num_section_blocks_with_references + 3, num_non_section_blocks);
 }
 
+TEST_F(CoffDecomposerTest, ParallelDecomposeMatchesSerialDecompose) {
+  CoffDecomposer serial_decomposer(image_file_);
+  EXPECT_EQ(1u, serial_decomposer.num_threads());
+  BlockGraph serial_block_graph;
+  ImageLayout serial_image_layout(&serial_block_graph);
+  ASSERT_TRUE(serial_decomposer.Decompose(&serial_image_layout));
+
+  CoffDecomposer parallel_decomposer(image_file_);
+  parallel_decomposer.set_num_threads(4);
+  EXPECT_EQ(4u, parallel_decomposer.num_threads());
+  BlockGraph parallel_block_graph;
+  ImageLayout parallel_image_layout(&parallel_block_graph);
+  ASSERT_TRUE(parallel_decomposer.Decompose(&parallel_image_layout));
+
+  // Blocks are created in the same order either way, so they have the same
+  // IDs, and they should have the same references.
+  ASSERT_EQ(serial_block_graph.blocks().size(),
+            parallel_block_graph.blocks().size());
+  BlockGraph::BlockMap::const_iterator it = serial_block_graph.blocks().begin();
+  for (; it != serial_block_graph.blocks().end(); ++it) {
+    const BlockGraph::Block& serial_block = it->second;
+    const BlockGraph::Block* parallel_block =
+        parallel_block_graph.GetBlockById(it->first);
+    ASSERT_TRUE(parallel_block != NULL);
+    EXPECT_EQ(serial_block.name(), parallel_block->name());
+    ASSERT_EQ(serial_block.references().size(),
+              parallel_block->references().size());
+
+    BlockGraph::Block::ReferenceMap::const_iterator serial_ref =
+        serial_block.references().begin();
+    BlockGraph::Block::ReferenceMap::const_iterator parallel_ref =
+        parallel_block->references().begin();
+    for (; serial_ref != serial_block.references().end();
+         ++serial_ref, ++parallel_ref) {
+      EXPECT_EQ(serial_ref->first, parallel_ref->first);
+      EXPECT_EQ(serial_ref->second.type(), parallel_ref->second.type());
+      EXPECT_EQ(serial_ref->second.size(), parallel_ref->second.size());
+      EXPECT_EQ(serial_ref->second.referenced()->id(),
+                parallel_ref->second.referenced()->id());
+      EXPECT_EQ(serial_ref->second.offset(), parallel_ref->second.offset());
+      EXPECT_EQ(serial_ref->second.base(), parallel_ref->second.base());
+    }
+  }
+}
+
 TEST_F(CoffDecomposerTest, FunctionsAndLabels) {
   // Decompose the test image and look at the result.
   CoffDecomposer decomposer(image_file_);
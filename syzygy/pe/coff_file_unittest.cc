@@ -72,6 +72,22 @@ TEST_F(CoffFileTest, Init) {
   EXPECT_EQ(0u, image_file_.file_header()->SizeOfOptionalHeader);
 }
 
+TEST_F(CoffFileTest, InitMapped) {
+  image_file_.set_use_file_mapping(true);
+  ASSERT_TRUE(image_file_.Init(test_dll_obj_path_));
+
+  EXPECT_TRUE(image_file_.file_header() != NULL);
+  EXPECT_TRUE(image_file_.section_headers() != NULL);
+  EXPECT_TRUE(image_file_.symbols() != NULL);
+  EXPECT_TRUE(image_file_.strings() != NULL);
+
+  CoffFile read_file;
+  ASSERT_TRUE(read_file.Init(test_dll_obj_path_));
+  EXPECT_EQ(0, ::memcmp(read_file.file_header(), image_file_.file_header(),
+                        sizeof(IMAGE_FILE_HEADER)));
+  EXPECT_EQ(read_file.symbols_size(), image_file_.symbols_size());
+}
+
 TEST_F(CoffFileTest, TranslateSectionOffsets) {
   ASSERT_TRUE(image_file_.Init(test_dll_obj_path_));
 
@@ -14,7 +14,11 @@
 
 #include "syzygy/pe/coff_relinker.h"
 
+#include <algorithm>
+
 #include "base/files/file_util.h"
+#include "syzygy/block_graph/block_util.h"
+#include "syzygy/core/file_util.h"
 #include "syzygy/pe/coff_decomposer.h"
 #include "syzygy/pe/coff_file_writer.h"
 #include "syzygy/pe/coff_image_layout_builder.h"
@@ -29,18 +33,22 @@ namespace {
 using block_graph::ApplyBlockGraphTransform;
 using block_graph::BlockGraph;
 using block_graph::OrderedBlockGraph;
+using block_graph::SetPhaseCounts;
 using core::RelativeAddress;
 
 typedef block_graph::BlockGraphOrdererInterface Orderer;
 typedef block_graph::BlockGraphTransformInterface Transform;
+typedef core::PhaseProfiler::ScopedPhase ScopedPhase;
 
 // Decompose @p image_file into @p image_layout.
 //
 // @param image_file the COFF file to decompose.
+// @param decomposer_threads the number of threads the decomposer uses.
 // @param image_layout the layout to fill with the results.
 // @param headers_block where to place the headers block pointer.
 // @returns true on success, or false on failure.
 bool Decompose(const CoffFile& image_file,
+               size_t decomposer_threads,
                ImageLayout* image_layout,
                BlockGraph::Block** headers_block) {
   DCHECK(image_layout != NULL);
@@ -50,6 +58,7 @@ bool Decompose(const CoffFile& image_file,
 
   // Decompose the input image.
   CoffDecomposer decomposer(image_file);
+  decomposer.set_num_threads(std::max<size_t>(1, decomposer_threads));
   if (!decomposer.Decompose(image_layout)) {
     LOG(ERROR) << "Unable to decompose module: "
                << image_file.path().value() << ".";
@@ -110,7 +119,7 @@ bool WriteImage(const ImageLayout& image_layout,
 }  // namespace
 
 CoffRelinker::CoffRelinker(const CoffTransformPolicy* transform_policy)
-    : PECoffRelinker(transform_policy) {
+    : PECoffRelinker(transform_policy), decomposer_threads_(1) {
 }
 
 bool CoffRelinker::Init() {
@@ -123,15 +132,25 @@ bool CoffRelinker::Init() {
   LOG(INFO) << "Input module: " << input_path_.value() << ".";
   LOG(INFO) << "Output module: " << output_path_.value() << ".";
 
-  // Open the input PE file.
+  // Open the input PE file. It's mapped rather than read unless it's about to
+  // be overwritten, as a mapped file can't be written.
+  input_image_file_.set_use_file_mapping(
+      core::CompareFilePaths(input_path_, output_path_) ==
+          core::kDistinctFilePaths);
   if (!input_image_file_.Init(input_path_)) {
     LOG(ERROR) << "Unable to load input image: " << input_path_.value() << ".";
     return false;
   }
 
   // Decompose the image.
-  if (!Decompose(input_image_file_, &input_image_layout_, &headers_block_))
-    return false;
+  {
+    ScopedPhase phase(core::PhaseProfiler::current(), "decompose");
+    if (!Decompose(input_image_file_, decomposer_threads_,
+                   &input_image_layout_, &headers_block_)) {
+      return false;
+    }
+    SetPhaseCounts(block_graph_, &phase);
+  }
 
   inited_ = true;
 
@@ -144,6 +163,8 @@ bool CoffRelinker::Relink() {
     return false;
   }
 
+  core::PhaseProfiler* profiler = core::PhaseProfiler::current();
+
   if (!ApplyUserTransforms())
     return false;
 
@@ -153,14 +174,19 @@ bool CoffRelinker::Relink() {
   //
   // TODO(chrisha): Remove CoffConvertLegacyCodeReferencesTransform when the
   //     basic block assembler is made fully COFF-compatible.
-  pe::transforms::CoffConvertLegacyCodeReferencesTransform fix_refs_tx;
-  pe::transforms::CoffPrepareHeadersTransform prep_headers_tx;
-  std::vector<Transform*> post_transforms;
-  post_transforms.push_back(&fix_refs_tx);
-  post_transforms.push_back(&prep_headers_tx);
-  if (!block_graph::ApplyBlockGraphTransforms(
-           post_transforms, transform_policy_, &block_graph_, headers_block_)) {
-    return false;
+  {
+    ScopedPhase phase(profiler, "finalize_block_graph");
+    pe::transforms::CoffConvertLegacyCodeReferencesTransform fix_refs_tx;
+    pe::transforms::CoffPrepareHeadersTransform prep_headers_tx;
+    std::vector<Transform*> post_transforms;
+    post_transforms.push_back(&fix_refs_tx);
+    post_transforms.push_back(&prep_headers_tx);
+    if (!block_graph::ApplyBlockGraphTransforms(
+             post_transforms, transform_policy_, &block_graph_,
+             headers_block_)) {
+      return false;
+    }
+    SetPhaseCounts(block_graph_, &phase);
   }
 
   OrderedBlockGraph ordered_graph(&block_graph_);
@@ -169,14 +195,20 @@ bool CoffRelinker::Relink() {
 
   // Lay it out.
   ImageLayout output_image_layout(&block_graph_);
-  if (!BuildImageLayout(ordered_graph, headers_block_,
-                        &output_image_layout)) {
-    return false;
+  {
+    ScopedPhase phase(profiler, "build_layout");
+    if (!BuildImageLayout(ordered_graph, headers_block_,
+                          &output_image_layout)) {
+      return false;
+    }
   }
 
   // Write the image.
-  if (!WriteImage(output_image_layout, output_path_))
-    return false;
+  {
+    ScopedPhase phase(profiler, "write_image");
+    if (!WriteImage(output_image_layout, output_path_))
+      return false;
+  }
 
   return true;
 }
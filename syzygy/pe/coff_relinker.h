@@ -93,6 +93,16 @@ class CoffRelinker : public PECoffRelinker {
   // @returns the original COFF file reader.
   const CoffFile& input_image_file() const { return input_image_file_; }
 
+  // @name Accessors and mutators.
+  // @{
+  // The number of threads on which the decomposer resolves relocations.
+  // Defaults to 1. @see CoffDecomposer::set_num_threads.
+  size_t decomposer_threads() const { return decomposer_threads_; }
+  void set_decomposer_threads(size_t decomposer_threads) {
+    decomposer_threads_ = decomposer_threads;
+  }
+  // @}
+
  private:
   // Check paths for existence and overwriting validity.
   //
@@ -102,6 +112,9 @@ class CoffRelinker : public PECoffRelinker {
   // The original COFF file reader.
   CoffFile input_image_file_;
 
+  // The number of threads on which the decomposer resolves relocations.
+  size_t decomposer_threads_;
+
   DISALLOW_COPY_AND_ASSIGN(CoffRelinker);
 };
 
@@ -20,6 +20,7 @@
 #include "base/command_line.h"
 #include "base/files/file_path.h"
 #include "base/files/file_util.h"
+#include "base/files/memory_mapped_file.h"
 #include "base/strings/string_util.h"
 #include "base/time/time.h"
 #include "syzygy/block_graph/block_graph.h"
@@ -106,6 +107,7 @@ int DecomposeApp::Run() {
 
   // Parse the PE File.
   pe::PEFile pe_file;
+  pe_file.set_use_file_mapping(true);
   {
     ScopedTimeLogger scoped_time_logger("Parsing PE file");
     if (!pe_file.Init(image_path_))
@@ -143,7 +145,8 @@ bool DecomposeApp::SaveDecomposedImage(
     const pe::PEFile& pe_file, const pe::ImageLayout& image_layout,
     const base::FilePath& output_path) const {
   base::ScopedFILE out_file(base::OpenFile(output_path, "wb"));
-  core::FileOutStream out_stream(out_file.get());
+  core::FileOutStream file_stream(out_file.get());
+  core::BufferedOutStream out_stream(&file_stream);
   core::NativeBinaryOutArchive out_archive(&out_stream);
 
   BlockGraphSerializer::Attributes attributes = 0;
@@ -174,19 +177,33 @@ bool DecomposeApp::SaveDecomposedImage(
 
 bool DecomposeApp::LoadDecomposedImage(const base::FilePath& file_path) const {
   pe::PEFile pe_file;
+  // A graph-only decomposition holds all of the block data. This is
+  // referenced in place from the mapped file, which must outlive the
+  // block-graph.
+  base::MemoryMappedFile mapped_file;
   BlockGraph block_graph;
 
-  base::ScopedFILE in_file(base::OpenFile(file_path, "rb"));
-  core::FileInStream in_stream(in_file.get());
-  core::NativeBinaryInArchive in_archive(&in_stream);
-
   if (graph_only_) {
+    if (!mapped_file.Initialize(file_path)) {
+      LOG(ERROR) << "Unable to map \"" << file_path.value() << "\".";
+      return false;
+    }
+    core::ScopedInStreamPtr in_stream(core::CreateByteInStream(
+        mapped_file.data(), mapped_file.data() + mapped_file.length()));
+    core::NativeBinaryInArchive in_archive(in_stream.get());
+
     BlockGraphSerializer bgs;
+    bgs.set_load_data_in_place(true);
     if (!bgs.Load(&block_graph, &in_archive)) {
       LOG(ERROR) << "Unable to load block-graph.";
       return false;
     }
   } else {
+    base::ScopedFILE in_file(base::OpenFile(file_path, "rb"));
+    core::FileInStream file_stream(in_file.get());
+    core::BufferedInStream in_stream(&file_stream);
+    core::NativeBinaryInArchive in_archive(&in_stream);
+
     pe::ImageLayout image_layout(&block_graph);
     BlockGraphSerializer::Attributes attributes = 0;
     if (!LoadBlockGraphAndImageLayout(&pe_file, &attributes, &image_layout,
@@ -15,10 +15,12 @@
 #include "syzygy/pe/decomposer.h"
 
 #include "pcrecpp.h"  // NOLINT
+#include "base/atomicops.h"
 #include "base/bind.h"
 #include "base/strings/string_split.h"
 #include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/threading/simple_thread.h"
 #include "base/win/scoped_bstr.h"
 #include "base/win/scoped_comptr.h"
 #include "syzygy/core/zstream.h"
@@ -30,6 +32,8 @@
 #include "syzygy/pdb/pdb_reader.h"
 #include "syzygy/pdb/pdb_symbol_record.h"
 #include "syzygy/pdb/pdb_util.h"
+#include "syzygy/pe/cvinfo_ext.h"
+#include "syzygy/pe/decomposition_cache.h"
 #include "syzygy/pe/dia_util.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/pe/pe_file_parser.h"
@@ -87,6 +91,10 @@ typedef std::vector<pdb::PdbFixup> PdbFixups;
 const char kJumpTable[] = "<jump-table>";
 const char kCaseTable[] = "<case-table>";
 
+// Ends the scope of an S_LPROC32_VS2013 or S_GPROC32_VS2013 symbol. This is not
+// in the enum in the cv_info file.
+const uint16_t kSymProcIdEnd = 0x114F;
+
 // The MS linker pads between code blocks with int3s.
 static const uint8_t kInt3 = 0xCC;
 static const size_t kPointerSize = BlockGraph::Reference::kMaximumSize;
@@ -185,6 +193,23 @@ KnownCompilerInfo kKnownCompilerInfos[] = {
   { L"Microsoft (R) LINK", false }
 };
 
+// Determines whether the compiler with the given name is one of those that we
+// whitelist.
+bool IsSupportedCompiler(const wchar_t* compiler_name) {
+  DCHECK_NE(reinterpret_cast<const wchar_t*>(NULL), compiler_name);
+
+  // Check the compiler name against the list of known compilers.
+  for (size_t i = 0; i < arraysize(kKnownCompilerInfos); ++i) {
+    if (::wcscmp(kKnownCompilerInfos[i].compiler_name, compiler_name) == 0) {
+      return kKnownCompilerInfos[i].supported;
+    }
+  }
+
+  // Anything we don't explicitly know about is not supported.
+  VLOG(1) << "Encountered unknown compiler: " << compiler_name;
+  return false;
+}
+
 // Given a compiland, determines whether the compiler used is one of those that
 // we whitelist.
 bool IsBuiltBySupportedCompiler(IDiaSymbol* compiland) {
@@ -210,16 +235,7 @@ bool IsBuiltBySupportedCompiler(IDiaSymbol* compiland) {
   HRESULT hr = compiland_details->get_compilerName(compiler_name.Receive());
   DCHECK_EQ(S_OK, hr);
 
-  // Check the compiler name against the list of known compilers.
-  for (size_t i = 0; i < arraysize(kKnownCompilerInfos); ++i) {
-    if (::wcscmp(kKnownCompilerInfos[i].compiler_name, compiler_name) == 0) {
-      return kKnownCompilerInfos[i].supported;
-    }
-  }
-
-  // Anything we don't explicitly know about is not supported.
-  VLOG(1) << "Encountered unknown compiler: " << compiler_name;
-  return false;
+  return IsSupportedCompiler(compiler_name);
 }
 
 // Adds an intermediate reference to the provided vector. The vector is
@@ -325,6 +341,55 @@ bool LoadDebugStreams(IDiaSession* dia_session,
   return true;
 }
 
+// Reads a debug stream of a PDB file whose index is stored in the DBI debug
+// header. This is the equivalent of FindAndLoadDiaDebugStreamByName.
+template <typename T>
+SearchResult ReadPdbDebugStream(const pdb::PdbFile& pdb_file,
+                                int16_t stream_index,
+                                std::vector<T>* list) {
+  DCHECK_NE(reinterpret_cast<std::vector<T>*>(NULL), list);
+
+  if (stream_index < 0)
+    return kSearchFailed;
+  scoped_refptr<pdb::PdbStream> stream = pdb_file.GetStream(stream_index);
+  if (stream.get() == NULL)
+    return kSearchFailed;
+
+  if (stream->length() % sizeof(T) != 0) {
+    LOG(ERROR) << "Debug stream " << stream_index << " has a length that is "
+               << "not a multiple of its record size.";
+    return kSearchErrored;
+  }
+
+  list->resize(stream->length() / sizeof(T));
+  if (!list->empty() &&
+      !stream->ReadBytesAt(0, stream->length(), list->data())) {
+    LOG(ERROR) << "Failed to read debug stream " << stream_index << ".";
+    return kSearchErrored;
+  }
+
+  return kSearchSucceeded;
+}
+
+// Loads the FIXUP debug stream using the in-house PDB readers.
+bool LoadPdbFixupStream(const pdb::PdbFile& pdb_file,
+                        const pdb::DbiStream& dbi_stream,
+                        PdbFixups* pdb_fixups) {
+  DCHECK_NE(reinterpret_cast<PdbFixups*>(NULL), pdb_fixups);
+
+  SearchResult search_result = ReadPdbDebugStream(
+      pdb_file, dbi_stream.dbg_header().fixup, pdb_fixups);
+  if (search_result != kSearchSucceeded) {
+    if (search_result == kSearchFailed) {
+      LOG(ERROR) << "PDB file does not contain a FIXUP stream. Module must be "
+                    "linked with '/PROFILE' or '/DEBUGINFO:FIXUP' flag.";
+    }
+    return false;
+  }
+
+  return true;
+}
+
 bool GetFixupDestinationAndType(const PEFile& image_file,
                                 const pdb::PdbFixup& fixup,
                                 RelativeAddress* dst_addr,
@@ -395,6 +460,11 @@ bool CreateReferencesFromFixupsImpl(
   bool have_omap = !omap_from.empty();
   size_t fixups_used = 0;
 
+  // Every fixup is translated twice, so index the OMAP information once.
+  pdb::OmapIndex omap_index;
+  if (have_omap)
+    omap_index.Init(omap_from);
+
   // The resource section in Chrome is modified post-link by a tool that adds a
   // manifest to it. This causes all of the fixups in the resource section (and
   // anything beyond it) to be invalid. As long as the resource section is the
@@ -433,8 +503,8 @@ bool CreateReferencesFromFixupsImpl(
     RelativeAddress src_addr(pdb_fixups[i].rva_location);
     RelativeAddress base_addr(pdb_fixups[i].rva_base);
     if (have_omap) {
-      src_addr = pdb::TranslateAddressViaOmap(omap_from, src_addr);
-      base_addr = pdb::TranslateAddressViaOmap(omap_from, base_addr);
+      src_addr = omap_index.Translate(src_addr);
+      base_addr = omap_index.Translate(base_addr);
     }
 
     // If the reference originates beyond the .rsrc section then we can't
@@ -558,9 +628,9 @@ scoped_refptr<pdb::PdbStream> GetLinkerSymbolStream(
     LOG(ERROR) << "Failed to read DBI stream.";
   }
 
-  // Parse the DBI stream.
+  // Parse the DBI stream. Only the module info is needed.
   pdb::DbiStream dbi;
-  if (!dbi.Read(dbi_stream.get())) {
+  if (!dbi.Init(dbi_stream.get()) || !dbi.ReadModules()) {
     LOG(ERROR) << "Unable to parse DBI stream.";
     return false;
   }
@@ -593,6 +663,23 @@ scoped_refptr<pdb::PdbStream> GetLinkerSymbolStream(
   return symbols;
 }
 
+// Gives a name to a block based on the basename of the object file of its
+// compiland. This will eventually be replaced by the full symbol name, if one
+// exists for the block.
+std::string GetCompilandBlockName(const std::string& compiland_name) {
+  size_t last_component = compiland_name.find_last_of('\\');
+  size_t extension = compiland_name.find_last_of('.');
+  if (last_component == std::string::npos) {
+    last_component = 0;
+  } else {
+    // We don't want to include the last slash.
+    ++last_component;
+  }
+  if (extension < last_component)
+    extension = compiland_name.size();
+  return compiland_name.substr(last_component, extension - last_component);
+}
+
 // Parses a symbol from a PDB symbol stream. The @p buffer is populated with the
 // data and upon success this returns the symbol directly cast onto the
 // @p buffer data. On failure this returns NULL.
@@ -619,6 +706,33 @@ const SymbolType* ParseSymbol(uint16_t symbol_length,
   return reinterpret_cast<const SymbolType*>(buffer->data());
 }
 
+// Reads the compiler name from an S_COMPILE2 or S_COMPILE3 symbol. Care must be
+// taken to ensure that |CompileSymType| agrees with the symbol type.
+template <typename CompileSymType>
+bool ReadCompilerName(uint16_t symbol_length,
+                      common::BinaryStreamReader* reader,
+                      std::vector<uint8_t>* buffer,
+                      base::string16* compiler_name) {
+  DCHECK_NE(static_cast<base::string16*>(nullptr), compiler_name);
+
+  const CompileSymType* compile_sym =
+      ParseSymbol<CompileSymType>(symbol_length, reader, buffer);
+  if (compile_sym == NULL)
+    return false;
+
+  // The version string is zero-terminated, and followed by the arguments.
+  size_t version_string = offsetof(CompileSymType, verSt);
+  const char* str = reinterpret_cast<const char*>(buffer->data()) +
+                    version_string;
+  size_t str_len = ::strnlen(str, buffer->size() - version_string);
+  if (!base::UTF8ToWide(str, str_len, compiler_name)) {
+    LOG(ERROR) << "Failed to convert compiler name to wide string.";
+    return false;
+  }
+
+  return true;
+}
+
 // If the given run of bytes consists of a single value repeated, returns that
 // value. Otherwise, returns -1.
 int RepeatedValue(const uint8_t* data, size_t size) {
@@ -811,9 +925,275 @@ struct Decomposer::VisitLinkerSymbolContext {
   DISALLOW_COPY_AND_ASSIGN(VisitLinkerSymbolContext);
 };
 
+// The information gathered from the symbol stream of a module by the PDB
+// reader decomposition steps.
+struct Decomposer::ModuleSymbols {
+  // A lexical block whose parent is a function.
+  struct LexicalBlock {
+    RelativeAddress function_rva;
+    size_t function_length;
+    RelativeAddress block_rva;
+  };
+
+  ModuleSymbols() : is_built_by_supported_compiler(false) {}
+
+  bool is_built_by_supported_compiler;
+  std::vector<LexicalBlock> lexical_blocks;
+};
+
+// Parses the symbol streams of the modules of a PDB. Each run parses the
+// symbol stream of the next module that no thread has claimed yet.
+class Decomposer::ModuleSymbolsParser
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  ModuleSymbolsParser(const PEFile& image_file,
+                      const pdb::PdbFile& pdb_file,
+                      const pdb::DbiStream& dbi_stream,
+                      ModuleSymbolsVector* module_symbols)
+      : image_file_(image_file), pdb_file_(pdb_file), dbi_stream_(dbi_stream),
+        module_symbols_(module_symbols), next_index_(0), failed_(0) {
+    DCHECK_NE(static_cast<ModuleSymbolsVector*>(nullptr), module_symbols);
+    DCHECK_EQ(dbi_stream.modules().size(), module_symbols->size());
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, module_symbols_->size());
+    if (!ParseModule(index))
+      base::subtle::NoBarrier_Store(&failed_, 1);
+  }
+  // @}
+
+  // Parses the symbol stream of a module. This may be called concurrently for
+  // distinct modules.
+  // @param index The index of the module to parse.
+  // @returns true on success, false otherwise.
+  bool ParseModule(size_t index);
+
+  // @returns true if parsing any of the modules failed.
+  bool failed() const { return base::subtle::NoBarrier_Load(&failed_) != 0; }
+
+ private:
+  // A scope opened by a symbol of a module symbol stream.
+  struct Scope {
+    bool is_function;
+    RelativeAddress rva;
+    size_t length;
+  };
+
+  // The state of the parse of a module symbol stream.
+  struct ParseContext {
+    ParseContext() : module_symbols(NULL), seen_compile_symbol(false) {}
+
+    ModuleSymbols* module_symbols;
+    // The currently open scopes, innermost last.
+    std::vector<Scope> scopes;
+    bool seen_compile_symbol;
+    std::vector<uint8_t> buffer;
+  };
+
+  // The VisitSymbolBatches callback. This visits each symbol of the batch.
+  bool VisitSymbolBatch(ParseContext* context,
+                        const pdb::SymbolRecordView* symbols,
+                        size_t symbol_count);
+
+  // Visits a single symbol.
+  bool VisitSymbol(ParseContext* context,
+                   uint16_t symbol_length,
+                   uint16_t symbol_type,
+                   common::BinaryStreamReader* reader);
+
+  // Translates a section index and offset to an address in the image.
+  // @returns true if @p section is a valid section index, false otherwise.
+  bool GetSymbolAddress(uint16_t section,
+                        uint32_t offset,
+                        RelativeAddress* rva) const;
+
+  const PEFile& image_file_;
+  const pdb::PdbFile& pdb_file_;
+  const pdb::DbiStream& dbi_stream_;
+  ModuleSymbolsVector* module_symbols_;
+
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(ModuleSymbolsParser);
+};
+
+bool Decomposer::ModuleSymbolsParser::ParseModule(size_t index) {
+  DCHECK_LT(index, module_symbols_->size());
+
+  // Modules without a symbol stream have no compiland details, and are thus
+  // deemed to be built by an unsupported compiler.
+  const pdb::DbiModuleInfo& module_info = dbi_stream_.modules()[index];
+  if (module_info.module_info_base().stream < 0 ||
+      module_info.module_info_base().symbol_bytes == 0) {
+    return true;
+  }
+
+  scoped_refptr<pdb::PdbStream> symbols =
+      pdb_file_.GetStream(module_info.module_info_base().stream);
+  if (symbols.get() == NULL ||
+      symbols->length() < module_info.module_info_base().symbol_bytes) {
+    LOG(ERROR) << "Unable to open the symbol stream of module \""
+               << module_info.module_name() << "\".";
+    return false;
+  }
+
+  // The symbols are decoded straight from the mapped PDB when possible, and
+  // otherwise from a single copy of the stream.
+  ParseContext context;
+  context.module_symbols = &(*module_symbols_)[index];
+  pdb::VisitSymbolBatchesCallback callback = base::Bind(
+      &ModuleSymbolsParser::VisitSymbolBatch,
+      base::Unretained(this),
+      base::Unretained(&context));
+  if (!pdb::VisitSymbolBatches(callback, 0,
+                               module_info.module_info_base().symbol_bytes,
+                               true, symbols.get())) {
+    LOG(ERROR) << "Failed to parse the symbol stream of module \""
+               << module_info.module_name() << "\".";
+    return false;
+  }
+
+  return true;
+}
+
+bool Decomposer::ModuleSymbolsParser::VisitSymbolBatch(
+    ParseContext* context,
+    const pdb::SymbolRecordView* symbols,
+    size_t symbol_count) {
+  DCHECK_NE(static_cast<ParseContext*>(nullptr), context);
+  DCHECK_NE(static_cast<const pdb::SymbolRecordView*>(nullptr), symbols);
+
+  for (size_t i = 0; i < symbol_count; ++i) {
+    common::BinaryBufferStreamReader reader(symbols[i].data,
+                                            symbols[i].length);
+    if (!VisitSymbol(context, symbols[i].length, symbols[i].type, &reader))
+      return false;
+  }
+
+  return true;
+}
+
+bool Decomposer::ModuleSymbolsParser::VisitSymbol(
+    ParseContext* context,
+    uint16_t symbol_length,
+    uint16_t symbol_type,
+    common::BinaryStreamReader* reader) {
+  DCHECK_NE(static_cast<ParseContext*>(nullptr), context);
+  DCHECK_NE(static_cast<common::BinaryStreamReader*>(nullptr), reader);
+
+  switch (symbol_type) {
+    case cci::S_COMPILE2:
+    case cci::S_COMPILE3: {
+      // Only the first compiland details are considered, as in
+      // IsBuiltBySupportedCompiler.
+      if (context->seen_compile_symbol)
+        return true;
+      context->seen_compile_symbol = true;
+
+      base::string16 compiler_name;
+      bool success = symbol_type == cci::S_COMPILE2 ?
+          ReadCompilerName<cci::CompileSym>(symbol_length, reader,
+                                            &context->buffer, &compiler_name) :
+          ReadCompilerName<CompileSym2>(symbol_length, reader,
+                                        &context->buffer, &compiler_name);
+      if (!success)
+        return false;
+      context->module_symbols->is_built_by_supported_compiler =
+          IsSupportedCompiler(compiler_name.c_str());
+      return true;
+    }
+
+    case cci::S_GPROC32:
+    case cci::S_LPROC32:
+    case cci::S_GPROC32_VS2013:
+    case cci::S_LPROC32_VS2013: {
+      const cci::ProcSym32* proc = ParseSymbol<cci::ProcSym32>(
+          symbol_length, reader, &context->buffer);
+      if (proc == NULL)
+        return false;
+      Scope scope = { false, RelativeAddress(), proc->len };
+      scope.is_function = GetSymbolAddress(proc->seg, proc->off, &scope.rva);
+      context->scopes.push_back(scope);
+      return true;
+    }
+
+    case cci::S_BLOCK32: {
+      const cci::BlockSym32* block = ParseSymbol<cci::BlockSym32>(
+          symbol_length, reader, &context->buffer);
+      if (block == NULL)
+        return false;
+
+      // Only consider function blocks.
+      RelativeAddress block_rva;
+      if (!context->scopes.empty() && context->scopes.back().is_function &&
+          GetSymbolAddress(block->seg, block->off, &block_rva)) {
+        const Scope& parent = context->scopes.back();
+        ModuleSymbols::LexicalBlock lexical_block = {
+            parent.rva, parent.length, block_rva };
+        context->module_symbols->lexical_blocks.push_back(lexical_block);
+      }
+
+      Scope scope = { false, block_rva, block->len };
+      context->scopes.push_back(scope);
+      return true;
+    }
+
+    // The other symbols that open a scope.
+    case cci::S_THUNK32:
+    case cci::S_WITH32:
+    case cci::S_SEPCODE:
+    case cci::S_GMANPROC:
+    case cci::S_LMANPROC:
+    case cci::S_INLINESITE: {
+      Scope scope = { false, RelativeAddress(), 0 };
+      context->scopes.push_back(scope);
+      return true;
+    }
+
+    case cci::S_END:
+    case cci::S_INLINESITE_END:
+    case kSymProcIdEnd: {
+      if (context->scopes.empty()) {
+        LOG(ERROR) << "Encountered a scope end symbol outside of any scope.";
+        return false;
+      }
+      context->scopes.pop_back();
+      return true;
+    }
+
+    default:
+      return true;
+  }
+}
+
+bool Decomposer::ModuleSymbolsParser::GetSymbolAddress(
+    uint16_t section,
+    uint32_t offset,
+    RelativeAddress* rva) const {
+  DCHECK_NE(static_cast<RelativeAddress*>(nullptr), rva);
+
+  // Sections are numbered from 1 to n in the PDB, while we do 0 to n - 1.
+  if (section == 0 ||
+      section > image_file_.nt_headers()->FileHeader.NumberOfSections) {
+    return false;
+  }
+  const IMAGE_SECTION_HEADER* header = image_file_.section_header(section - 1);
+  DCHECK_NE(static_cast<const IMAGE_SECTION_HEADER*>(nullptr), header);
+  *rva = RelativeAddress(header->VirtualAddress + offset);
+  return true;
+}
+
 Decomposer::Decomposer(const PEFile& image_file)
-    : image_file_(image_file), image_layout_(NULL), image_(NULL),
-      current_block_(NULL), current_scope_count_(0) {
+    : image_file_(image_file), pdb_reader_threads_(0),
+      cache_directory_(DecompositionCache::GetDirectoryFromEnvironment()),
+      image_layout_(NULL), image_(NULL), current_block_(NULL),
+      current_scope_count_(0) {
 }
 
 bool Decomposer::Decompose(ImageLayout* image_layout) {
@@ -843,6 +1223,27 @@ bool Decomposer::Decompose(ImageLayout* image_layout) {
     return false;
   }
 
+  // Then try the decomposition cache, which is shared by all the tools that
+  // process the image.
+  std::unique_ptr<DecompositionCache> cache;
+  if (!cache_directory_.empty()) {
+    cache.reset(new DecompositionCache(cache_directory_));
+    if (cache->Load(image_file_, image_layout)) {
+      LOG(INFO) << "Read decomposition from cache: "
+                << cache_directory_.value();
+      return true;
+    }
+
+    // A failed load may have left a partial decomposition behind, which
+    // can't be undone. Drop the entry so that the next run starts afresh.
+    if (!image_layout->blocks.graph()->blocks().empty()) {
+      LOG(ERROR) << "Failed to read decomposition from cache: "
+                 << cache_directory_.value();
+      cache->Remove(image_file_);
+      return false;
+    }
+  }
+
   // At this point a full decomposition needs to be performed.
   image_layout_ = image_layout;
   image_ = &(image_layout->blocks);
@@ -850,6 +1251,12 @@ bool Decomposer::Decompose(ImageLayout* image_layout) {
   image_layout_ = NULL;
   image_ = NULL;
 
+  // A failure to populate the cache doesn't affect the decomposition.
+  if (success && cache.get() != NULL &&
+      !cache->Save(image_file_, *image_layout)) {
+    LOG(WARNING) << "Failed to save decomposition to cache.";
+  }
+
   return success;
 }
 
@@ -949,7 +1356,7 @@ bool Decomposer::LoadBlockGraphFromPdb(const base::FilePath& pdb_path,
 
   pdb::PdbFile pdb_file;
   pdb::PdbReader pdb_reader;
-  if (!pdb_reader.Read(pdb_path, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(pdb_path, &pdb_file)) {
     LOG(ERROR) << "Unable to read the PDB named \"" << pdb_path.value()
                << "\".";
     return NULL;
@@ -992,6 +1399,34 @@ bool Decomposer::DecomposeImpl() {
     return false;
   }
 
+  // When using the in-house PDB readers the module symbol streams are parsed
+  // up front, as this doesn't depend on the blocks.
+  pdb::PdbFile pdb_file;
+  pdb::DbiStream dbi_stream;
+  ModuleSymbolsVector module_symbols;
+  bool use_pdb_reader = pdb_reader_threads_ > 0;
+  if (use_pdb_reader) {
+    pdb::PdbReader pdb_reader;
+    if (!pdb_reader.ReadMapped(pdb_path_, &pdb_file)) {
+      LOG(ERROR) << "Failed to load PDB: " << pdb_path_.value();
+      return false;
+    }
+    if (!ReadDbiStream(pdb_file, &dbi_stream))
+      return false;
+
+    // The addresses in the PDB of an image that was rewritten post-link have
+    // to be translated via OMAP, which DIA takes care of.
+    if (dbi_stream.dbg_header().omap_from_src >= 0) {
+      LOG(INFO) << "PDB contains OMAP information, decomposing with DIA.";
+      use_pdb_reader = false;
+    } else {
+      VLOG(1) << "Parsing module symbols on " << pdb_reader_threads_
+              << " thread(s).";
+      if (!ParseModuleSymbols(pdb_file, dbi_stream, &module_symbols))
+        return false;
+    }
+  }
+
   // Copy the image headers to the layout.
   CopySectionHeadersToImageLayout(
       image_file_.nt_headers()->FileHeader.NumberOfSections,
@@ -1023,12 +1458,20 @@ bool Decomposer::DecomposeImpl() {
     // existing PE parsed blocks, but when they do we expect them to be exact
     // collisions.
     VLOG(1) << "Parsing section contributions.";
-    if (!CreateBlocksFromSectionContribs(dia_session.get()))
+    if (use_pdb_reader) {
+      if (!CreateBlocksFromDbiSectionContribs(dbi_stream, module_symbols))
+        return false;
+    } else if (!CreateBlocksFromSectionContribs(dia_session.get())) {
       return false;
+    }
 
     VLOG(1) << "Finding cold blocks.";
-    if (!FindColdBlocksFromCompilands(dia_session.get()))
+    if (use_pdb_reader) {
+      if (!FindColdBlocksFromModuleSymbols(module_symbols))
+        return false;
+    } else if (!FindColdBlocksFromCompilands(dia_session.get())) {
       return false;
+    }
 
     // Flesh out the rest of the image with gap blocks.
     VLOG(1) << "Creating gap blocks.";
@@ -1043,10 +1486,16 @@ bool Decomposer::DecomposeImpl() {
 
   // Parse the fixups and use them to create references.
   VLOG(1) << "Parsing fixups.";
-  if (!CreateReferencesFromFixups(dia_session.get()))
+  if (use_pdb_reader) {
+    if (!CreateReferencesFromPdbFixups(pdb_file, dbi_stream))
+      return false;
+  } else if (!CreateReferencesFromFixups(dia_session.get())) {
     return false;
+  }
 
-  // Annotate the block-graph with symbol information.
+  // Annotate the block-graph with symbol information. This always goes through
+  // DIA, as it relies on its naming of the symbols and on its lexical
+  // hierarchy.
   VLOG(1) << "Parsing symbols.";
   if (!ProcessSymbols(global.get()))
     return false;
@@ -1091,7 +1540,7 @@ bool Decomposer::CreatePEImageBlocksAndReferences(
 bool Decomposer::CreateBlocksFromCoffGroups() {
   pdb::PdbFile pdb_file;
   pdb::PdbReader pdb_reader;
-  if (!pdb_reader.Read(pdb_path_, &pdb_file)) {
+  if (!pdb_reader.ReadMapped(pdb_path_, &pdb_file)) {
     LOG(ERROR) << "Failed to load PDB: " << pdb_path_.value();
     return false;
   }
@@ -1191,45 +1640,11 @@ bool Decomposer::CreateBlocksFromSectionContribs(IDiaSession* session) {
       return false;
     }
 
-    // Give a name to the block based on the basename of the object file. This
-    // will eventually be replaced by the full symbol name, if one exists for
-    // the block.
-    size_t last_component = compiland_name.find_last_of('\\');
-    size_t extension = compiland_name.find_last_of('.');
-    if (last_component == std::string::npos) {
-      last_component = 0;
-    } else {
-      // We don't want to include the last slash.
-      ++last_component;
-    }
-    if (extension < last_component)
-      extension = compiland_name.size();
-    std::string name = compiland_name.substr(last_component,
-                                             extension - last_component);
-
-    // TODO(chrisha): We see special section contributions with the name
-    //     "* CIL *". These are concatenations of data symbols and can very
-    //     likely be chunked using symbols directly. A cursory visual inspection
-    //     of symbol names hints that these might be related to WPO.
-
-    // Create the block.
-    BlockType block_type =
-        code ? BlockGraph::CODE_BLOCK : BlockGraph::DATA_BLOCK;
-    Block* block = CreateBlockOrFindCoveringPeBlock(
-        block_type, RelativeAddress(rva), length, name);
-    if (block == NULL) {
-      LOG(ERROR) << "Unable to create block for compiland \""
-                 << compiland_name << "\".";
+    if (!CreateSectionContribBlock(RelativeAddress(rva), length, code != FALSE,
+                                   compiland_name,
+                                   is_built_by_supported_compiler)) {
       return false;
     }
-
-    // Set the block compiland name.
-    block->set_compiland_name(compiland_name);
-
-    // Set the block attributes.
-    block->set_attribute(BlockGraph::SECTION_CONTRIB);
-    if (!is_built_by_supported_compiler)
-      block->set_attribute(BlockGraph::BUILT_BY_UNSUPPORTED_COMPILER);
   }
 
   return true;
@@ -1320,36 +1735,11 @@ bool Decomposer::FindColdBlocksFromCompilands(IDiaSession* session) {
         return false;
       }
 
-      // Retrieve the function block.
-      Block* func_block = image_->GetBlockByAddress(RelativeAddress(func_rva));
-      if (func_block == NULL) {
-        LOG(ERROR) << "Cannot retrieve parent block.";
+      if (!AddColdBlock(RelativeAddress(func_rva),
+                        static_cast<size_t>(func_length),
+                        RelativeAddress(block_rva))) {
         return false;
       }
-
-      // Skip blocks within the range of its parent.
-      if (block_rva >= func_rva && block_rva <= func_rva + func_length)
-        continue;
-
-      // A cold block is detected and needs special handling.
-      Block* cold_block = image_->GetBlockByAddress(RelativeAddress(block_rva));
-      if (cold_block == NULL) {
-        LOG(ERROR) << "Cannot retrieve parent block.";
-        return false;
-      }
-
-      RelativeAddress cold_block_addr;
-      if (!image_->GetAddressOf(cold_block, &cold_block_addr)) {
-        LOG(ERROR) << "Cannot retrieve cold block address.";
-        return false;
-      }
-
-      // Add cold_block as a child of the function block.
-      cold_blocks_[func_block][cold_block_addr] = cold_block;
-
-      // Set the parent relation for blocks belonging to the function block.
-      cold_blocks_parent_[func_block] = func_block;
-      cold_blocks_parent_[cold_block] = func_block;
     }
   }
 
@@ -1410,22 +1800,239 @@ bool Decomposer::FinalizeIntermediateReferences(
 bool Decomposer::CreateReferencesFromFixups(IDiaSession* session) {
   DCHECK_NE(reinterpret_cast<IDiaSession*>(NULL), session);
 
-  PEFile::RelocSet reloc_set;
-  if (!image_file_.DecodeRelocs(&reloc_set))
-    return false;
-
   OMAPs omap_from;
   PdbFixups fixups;
   if (!LoadDebugStreams(session, &fixups, &omap_from))
     return false;
 
+  return CreateReferencesFromFixupsAndRelocs(fixups, omap_from);
+}
+
+bool Decomposer::ReadDbiStream(const pdb::PdbFile& pdb_file,
+                               pdb::DbiStream* dbi_stream) {
+  DCHECK_NE(static_cast<pdb::DbiStream*>(nullptr), dbi_stream);
+
+  scoped_refptr<pdb::PdbStream> stream = pdb_file.GetStream(pdb::kDbiStream);
+  if (stream.get() == NULL) {
+    LOG(ERROR) << "PDB does not contain a DBI stream.";
+    return false;
+  }
+
+  // Read the entire thing into memory before parsing it. This makes parsing
+  // much faster.
+  scoped_refptr<pdb::PdbByteStream> byte_stream(new pdb::PdbByteStream());
+  if (!byte_stream->Init(stream.get())) {
+    LOG(ERROR) << "Failed to read DBI stream.";
+    return false;
+  }
+
+  if (!dbi_stream->Read(byte_stream.get())) {
+    LOG(ERROR) << "Unable to parse DBI stream.";
+    return false;
+  }
+
+  return true;
+}
+
+bool Decomposer::ParseModuleSymbols(const pdb::PdbFile& pdb_file,
+                                    const pdb::DbiStream& dbi_stream,
+                                    ModuleSymbolsVector* module_symbols) {
+  DCHECK_NE(static_cast<ModuleSymbolsVector*>(nullptr), module_symbols);
+  DCHECK_LT(0u, pdb_reader_threads_);
+
+  size_t num_modules = dbi_stream.modules().size();
+  module_symbols->clear();
+  module_symbols->resize(num_modules);
+  if (num_modules == 0)
+    return true;
+
+  ModuleSymbolsParser parser(image_file_, pdb_file, dbi_stream,
+                             module_symbols);
+  if (pdb_reader_threads_ == 1 || num_modules == 1) {
+    for (size_t i = 0; i < num_modules; ++i) {
+      if (!parser.ParseModule(i))
+        return false;
+    }
+    return true;
+  }
+
+  base::DelegateSimpleThreadPool pool(
+      "PdbModuleSymbolsParser",
+      static_cast<int>(std::min(pdb_reader_threads_, num_modules)));
+  pool.Start();
+  pool.AddWork(&parser, static_cast<int>(num_modules));
+  pool.JoinAll();
+
+  // The failure has already been logged.
+  return !parser.failed();
+}
+
+bool Decomposer::CreateBlocksFromDbiSectionContribs(
+    const pdb::DbiStream& dbi_stream,
+    const ModuleSymbolsVector& module_symbols) {
+  DCHECK_EQ(dbi_stream.modules().size(), module_symbols.size());
+
+  size_t rsrc_id = image_file_.GetSectionIndex(kResourceSectionName);
+  size_t num_sections = image_file_.nt_headers()->FileHeader.NumberOfSections;
+
+  for (const pdb::DbiSectionContrib& section_contrib :
+       dbi_stream.section_contribs()) {
+    // The PDB numbers sections from 1 to n, while we do 0 to n - 1.
+    if (section_contrib.section <= 0 ||
+        static_cast<size_t>(section_contrib.section) > num_sections) {
+      LOG(ERROR) << "Section contribution refers to invalid section "
+                 << section_contrib.section << ".";
+      return false;
+    }
+    size_t section_id = section_contrib.section - 1;
+
+    // We don't parse the resource section, as it is parsed by the PEFileParser.
+    if (section_id == rsrc_id)
+      continue;
+
+    if (section_contrib.module < 0 ||
+        static_cast<size_t>(section_contrib.module) >= module_symbols.size()) {
+      LOG(ERROR) << "Section contribution refers to invalid module "
+                 << section_contrib.module << ".";
+      return false;
+    }
+
+    const IMAGE_SECTION_HEADER* header = image_file_.section_header(section_id);
+    DCHECK_NE(static_cast<const IMAGE_SECTION_HEADER*>(nullptr), header);
+    RelativeAddress rva(header->VirtualAddress + section_contrib.offset);
+    bool code = (section_contrib.flags & IMAGE_SCN_CNT_CODE) != 0;
+
+    if (!CreateSectionContribBlock(
+            rva, section_contrib.size, code,
+            dbi_stream.modules()[section_contrib.module].module_name(),
+            module_symbols[section_contrib.module]
+                .is_built_by_supported_compiler)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Decomposer::FindColdBlocksFromModuleSymbols(
+    const ModuleSymbolsVector& module_symbols) {
+  // See FindColdBlocksFromCompilands.
+  for (const ModuleSymbols& symbols : module_symbols) {
+    for (const ModuleSymbols::LexicalBlock& lexical_block :
+         symbols.lexical_blocks) {
+      if (!AddColdBlock(lexical_block.function_rva,
+                        lexical_block.function_length,
+                        lexical_block.block_rva)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool Decomposer::CreateReferencesFromPdbFixups(
+    const pdb::PdbFile& pdb_file,
+    const pdb::DbiStream& dbi_stream) {
+  // The OMAP case is handled by DIA, see DecomposeImpl.
+  DCHECK_GT(0, dbi_stream.dbg_header().omap_from_src);
+
+  PdbFixups fixups;
+  if (!LoadPdbFixupStream(pdb_file, dbi_stream, &fixups))
+    return false;
+
+  return CreateReferencesFromFixupsAndRelocs(fixups, OMAPs());
+}
+
+bool Decomposer::CreateSectionContribBlock(
+    RelativeAddress address,
+    BlockGraph::Size size,
+    bool code,
+    const std::string& compiland_name,
+    bool is_built_by_supported_compiler) {
+  std::string name = GetCompilandBlockName(compiland_name);
+
+  // TODO(chrisha): We see special section contributions with the name
+  //     "* CIL *". These are concatenations of data symbols and can very
+  //     likely be chunked using symbols directly. A cursory visual inspection
+  //     of symbol names hints that these might be related to WPO.
+
+  // Create the block.
+  BlockType block_type =
+      code ? BlockGraph::CODE_BLOCK : BlockGraph::DATA_BLOCK;
+  Block* block = CreateBlockOrFindCoveringPeBlock(
+      block_type, address, size, name);
+  if (block == NULL) {
+    LOG(ERROR) << "Unable to create block for compiland \""
+               << compiland_name << "\".";
+    return false;
+  }
+
+  // Set the block compiland name.
+  block->set_compiland_name(compiland_name);
+
+  // Set the block attributes.
+  block->set_attribute(BlockGraph::SECTION_CONTRIB);
+  if (!is_built_by_supported_compiler)
+    block->set_attribute(BlockGraph::BUILT_BY_UNSUPPORTED_COMPILER);
+
+  return true;
+}
+
+bool Decomposer::AddColdBlock(RelativeAddress func_rva,
+                              size_t func_length,
+                              RelativeAddress block_rva) {
+  // Retrieve the function block.
+  Block* func_block = image_->GetBlockByAddress(func_rva);
+  if (func_block == NULL) {
+    LOG(ERROR) << "Cannot retrieve parent block.";
+    return false;
+  }
+
+  // Skip blocks within the range of its parent.
+  if (block_rva >= func_rva && block_rva <= func_rva + func_length)
+    return true;
+
+  // A cold block is detected and needs special handling.
+  Block* cold_block = image_->GetBlockByAddress(block_rva);
+  if (cold_block == NULL) {
+    LOG(ERROR) << "Cannot retrieve parent block.";
+    return false;
+  }
+
+  RelativeAddress cold_block_addr;
+  if (!image_->GetAddressOf(cold_block, &cold_block_addr)) {
+    LOG(ERROR) << "Cannot retrieve cold block address.";
+    return false;
+  }
+
+  // Add cold_block as a child of the function block.
+  cold_blocks_[func_block][cold_block_addr] = cold_block;
+
+  // Set the parent relation for blocks belonging to the function block.
+  cold_blocks_parent_[func_block] = func_block;
+  cold_blocks_parent_[cold_block] = func_block;
+
+  return true;
+}
+
+bool Decomposer::CreateReferencesFromFixupsAndRelocs(
+    const std::vector<pdb::PdbFixup>& fixups,
+    const std::vector<OMAP>& omap_from) {
+  PEFile::RelocSet reloc_set;
+  if (!image_file_.DecodeRelocs(&reloc_set))
+    return false;
+
   // While creating references from the fixups this removes the
   // corresponding reference data from the relocs. We use this as a kind of
   // double-entry bookkeeping to ensure all is well and right in the world.
-  if (!CreateReferencesFromFixupsImpl(image_file_, fixups, omap_from,
-                                      &reloc_set, image_)) {
+  // This only looks up blocks, so the image is frozen for the duration.
+  image_->Freeze();
+  bool created = CreateReferencesFromFixupsImpl(image_file_, fixups,
+                                                omap_from, &reloc_set, image_);
+  image_->Thaw();
+  if (!created)
     return false;
-  }
 
   if (!reloc_set.empty()) {
     LOG(ERROR) << "Found reloc entries without matching FIXUP entries.";
@@ -23,6 +23,9 @@
 #include <vector>
 
 #include "syzygy/common/binary_stream.h"
+#include "syzygy/pdb/omap.h"
+#include "syzygy/pdb/pdb_data.h"
+#include "syzygy/pdb/pdb_dbi_stream.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_stream.h"
 #include "syzygy/pe/dia_browser.h"
@@ -64,6 +67,21 @@ class Decomposer {
   // @param pdb_path the path to the PDB file to be used in decomposing the
   //     image.
   void set_pdb_path(const base::FilePath& pdb_path) { pdb_path_ = pdb_path; }
+  // Sets the number of threads used to parse the module symbol streams of the
+  // PDB with the in-house PDB readers. When this is zero, the default, the
+  // section contributions, the cold blocks and the fixups are read via DIA
+  // instead.
+  // @param pdb_reader_threads the number of worker threads.
+  void set_pdb_reader_threads(size_t pdb_reader_threads) {
+    pdb_reader_threads_ = pdb_reader_threads;
+  }
+  // Sets the directory of the decomposition cache. This defaults to the
+  // directory named by DecompositionCache::kCacheDirectoryEnvVar. When it's
+  // empty no cache is used.
+  // @param cache_directory the directory holding the cache entries.
+  void set_cache_directory(const base::FilePath& cache_directory) {
+    cache_directory_ = cache_directory;
+  }
   // @}
 
   // @name Accessors
@@ -73,6 +91,8 @@ class Decomposer {
   // decomposition.
   // @returns the PDB path.
   const base::FilePath& pdb_path() const { return pdb_path_; }
+  size_t pdb_reader_threads() const { return pdb_reader_threads_; }
+  const base::FilePath& cache_directory() const { return cache_directory_; }
   // @}
 
  protected:
@@ -121,6 +141,53 @@ class Decomposer {
   bool ProcessSymbols(IDiaSymbol* root);
   // @}
 
+  // @name Alternatives to the DIA-based decomposition steps, which use the
+  //     in-house PDB readers. The module symbol streams are parsed in
+  //     parallel, on pdb_reader_threads_ worker threads.
+  // @{
+  struct ModuleSymbols;
+  typedef std::vector<ModuleSymbols> ModuleSymbolsVector;
+  class ModuleSymbolsParser;
+  // Reads the DBI stream of @p pdb_file.
+  static bool ReadDbiStream(const pdb::PdbFile& pdb_file,
+                            pdb::DbiStream* dbi_stream);
+  // Parses the symbol stream of each module of @p dbi_stream.
+  bool ParseModuleSymbols(const pdb::PdbFile& pdb_file,
+                          const pdb::DbiStream& dbi_stream,
+                          ModuleSymbolsVector* module_symbols);
+  // Processes the section contributions of @p dbi_stream, creating code/data
+  // blocks from them.
+  bool CreateBlocksFromDbiSectionContribs(
+      const pdb::DbiStream& dbi_stream,
+      const ModuleSymbolsVector& module_symbols);
+  // Finds cold blocks from the lexical blocks of the module symbols.
+  bool FindColdBlocksFromModuleSymbols(
+      const ModuleSymbolsVector& module_symbols);
+  // Creates inter-block references from the fixup stream of @p pdb_file.
+  bool CreateReferencesFromPdbFixups(const pdb::PdbFile& pdb_file,
+                                     const pdb::DbiStream& dbi_stream);
+  // @}
+
+  // @name Helpers shared by the DIA and the PDB reader decomposition steps.
+  // @{
+  // Creates the block for a section contribution.
+  bool CreateSectionContribBlock(RelativeAddress address,
+                                 BlockGraph::Size size,
+                                 bool code,
+                                 const std::string& compiland_name,
+                                 bool is_built_by_supported_compiler);
+  // Records the block at @p block_rva as a cold block of the function at
+  // @p func_rva, if it lies outside of the function.
+  bool AddColdBlock(RelativeAddress func_rva,
+                    size_t func_length,
+                    RelativeAddress block_rva);
+  // Creates references from @p fixups, and validates them against the
+  // relocations of the image.
+  bool CreateReferencesFromFixupsAndRelocs(
+      const std::vector<pdb::PdbFixup>& fixups,
+      const std::vector<OMAP>& omap_from);
+  // @}
+
   // @{
   // @name Callbacks and context structures used by the COFF group parsing
   //     mechanism.
@@ -198,6 +265,10 @@ class Decomposer {
   const PEFile& image_file_;
   // The path to corresponding PDB file.
   base::FilePath pdb_path_;
+  // The number of threads parsing the PDB, or zero to use DIA.
+  size_t pdb_reader_threads_;
+  // The directory of the decomposition cache, or empty if there is none.
+  base::FilePath cache_directory_;
 
   // @name Temporaries that are only valid while inside DecomposeImpl.
   //     Prevents us from having to pass these around everywhere.
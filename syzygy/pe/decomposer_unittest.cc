@@ -79,9 +79,17 @@ TEST_F(DecomposerTest, MutatorsAndAccessors) {
 
   Decomposer decomposer(image_file);
   EXPECT_TRUE(decomposer.pdb_path().empty());
+  EXPECT_EQ(0u, decomposer.pdb_reader_threads());
 
   decomposer.set_pdb_path(pdb_path);
   EXPECT_EQ(pdb_path, decomposer.pdb_path());
+
+  decomposer.set_pdb_reader_threads(4);
+  EXPECT_EQ(4u, decomposer.pdb_reader_threads());
+
+  base::FilePath cache_directory(temp_dir_.Append(L"cache"));
+  decomposer.set_cache_directory(cache_directory);
+  EXPECT_EQ(cache_directory, decomposer.cache_directory());
 }
 
 TEST_F(DecomposerTest, Decompose) {
@@ -348,6 +356,61 @@ TEST_F(DecomposerTest, Decompose) {
   EXPECT_EQ(8u, coff_group_blocks);
 }
 
+TEST_F(DecomposerTest, DecomposeWithPdbReaderMatchesDia) {
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  PEFile image_file;
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer dia_decomposer(image_file);
+  BlockGraph dia_block_graph;
+  ImageLayout dia_image_layout(&dia_block_graph);
+  ASSERT_TRUE(dia_decomposer.Decompose(&dia_image_layout));
+
+  // Decompose serially and in parallel.
+  static const size_t kThreads[] = { 1, 4 };
+  for (size_t threads : kThreads) {
+    Decomposer decomposer(image_file);
+    decomposer.set_pdb_reader_threads(threads);
+    BlockGraph block_graph;
+    ImageLayout image_layout(&block_graph);
+    ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+    // The blocks match those obtained via DIA, at the same addresses.
+    ASSERT_EQ(dia_image_layout.blocks.size(), image_layout.blocks.size());
+    BlockGraph::AddressSpace::RangeMapConstIter dia_it =
+        dia_image_layout.blocks.begin();
+    BlockGraph::AddressSpace::RangeMapConstIter it =
+        image_layout.blocks.begin();
+    for (; it != image_layout.blocks.end(); ++it, ++dia_it) {
+      const BlockGraph::Block* dia_block = dia_it->second;
+      const BlockGraph::Block* block = it->second;
+      EXPECT_EQ(dia_it->first, it->first);
+      EXPECT_EQ(dia_block->type(), block->type());
+      EXPECT_EQ(dia_block->name(), block->name());
+      EXPECT_EQ(dia_block->compiland_name(), block->compiland_name());
+      EXPECT_EQ(dia_block->attributes(), block->attributes());
+      EXPECT_EQ(dia_block->alignment(), block->alignment());
+      EXPECT_EQ(dia_block->labels(), block->labels());
+
+      // So do their references.
+      ASSERT_EQ(dia_block->references().size(), block->references().size());
+      BlockGraph::Block::ReferenceMap::const_iterator dia_ref_it =
+          dia_block->references().begin();
+      BlockGraph::Block::ReferenceMap::const_iterator ref_it =
+          block->references().begin();
+      for (; ref_it != block->references().end(); ++ref_it, ++dia_ref_it) {
+        EXPECT_EQ(dia_ref_it->first, ref_it->first);
+        EXPECT_EQ(dia_ref_it->second.type(), ref_it->second.type());
+        EXPECT_EQ(dia_ref_it->second.size(), ref_it->second.size());
+        EXPECT_EQ(dia_ref_it->second.offset(), ref_it->second.offset());
+        EXPECT_EQ(dia_ref_it->second.base(), ref_it->second.base());
+        EXPECT_EQ(dia_ref_it->second.referenced()->addr(),
+                  ref_it->second.referenced()->addr());
+      }
+    }
+  }
+}
+
 TEST_F(DecomposerTest, DecomposeFailsWithNonexistentPdb) {
   base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
   PEFile image_file;
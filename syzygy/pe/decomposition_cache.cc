@@ -0,0 +1,205 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/decomposition_cache.h"
+
+#include <memory>
+
+#include "base/environment.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/strings/stringprintf.h"
+#include "base/strings/utf_string_conversions.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/pe/pdb_info.h"
+#include "syzygy/pe/serialization.h"
+
+namespace pe {
+
+namespace {
+
+// The version of the cache entry format. Bump this whenever the format of the
+// entries changes in a way that the block graph serializer doesn't detect.
+const uint32_t kCacheVersion = 1;
+
+// The extension of the cache entries.
+const char kEntryExtension[] = ".bg";
+
+}  // namespace
+
+const char DecompositionCache::kCacheDirectoryEnvVar[] =
+    "SYZYGY_DECOMPOSITION_CACHE";
+
+base::FilePath DecompositionCache::GetDirectoryFromEnvironment() {
+  std::unique_ptr<base::Environment> env(base::Environment::Create());
+  DCHECK(env.get() != NULL);
+
+  std::string directory;
+  if (!env->GetVar(kCacheDirectoryEnvVar, &directory) || directory.empty())
+    return base::FilePath();
+  return base::FilePath(base::UTF8ToWide(directory));
+}
+
+DecompositionCache::DecompositionCache(const base::FilePath& directory)
+    : directory_(directory) {
+}
+
+bool DecompositionCache::GetKey(const PEFile& pe_file, std::string* key) {
+  DCHECK(key != NULL);
+
+  PEFile::Signature signature;
+  pe_file.GetSignature(&signature);
+
+  // The image signature alone doesn't tell apart two builds of an image with
+  // a zeroed time stamp and checksum, so the PDB identity goes in as well.
+  PdbInfo pdb_info;
+  if (!pdb_info.Init(pe_file)) {
+    LOG(ERROR) << "Unable to read PDB information of "
+               << pe_file.path().value() << ".";
+    return false;
+  }
+  const GUID& guid = pdb_info.signature();
+
+  *key = base::StringPrintf(
+      "%08X%08X%08X%08X-%08X%04X%04X",
+      signature.base_address.value(),
+      static_cast<uint32_t>(signature.module_size),
+      signature.module_checksum,
+      signature.module_time_date_stamp,
+      guid.Data1, guid.Data2, guid.Data3);
+  for (size_t i = 0; i < arraysize(guid.Data4); ++i)
+    base::StringAppendF(key, "%02X", guid.Data4[i]);
+  base::StringAppendF(key, "-%X", pdb_info.pdb_age());
+
+  return true;
+}
+
+bool DecompositionCache::GetEntryPath(const PEFile& pe_file,
+                                      base::FilePath* path) const {
+  DCHECK(path != NULL);
+  DCHECK(!directory_.empty());
+
+  std::string key;
+  if (!GetKey(pe_file, &key))
+    return false;
+  *path = directory_.AppendASCII(key + kEntryExtension);
+  return true;
+}
+
+bool DecompositionCache::Load(const PEFile& pe_file,
+                              ImageLayout* image_layout) const {
+  DCHECK(image_layout != NULL);
+
+  std::string key;
+  if (!GetKey(pe_file, &key))
+    return false;
+  base::FilePath path = directory_.AppendASCII(key + kEntryExtension);
+
+  // A missing entry is the common case, so it goes unreported.
+  base::ScopedFILE file(base::OpenFile(path, "rb"));
+  if (file.get() == NULL)
+    return false;
+
+  core::FileInStream file_stream(file.get());
+  core::BufferedInStream in_stream(&file_stream);
+  core::NativeBinaryInArchive in_archive(&in_stream);
+  uint32_t version = 0;
+  std::string entry_key;
+  if (!in_archive.Load(&version) || !in_archive.Load(&entry_key)) {
+    LOG(ERROR) << "Unable to read decomposition cache entry: "
+               << path.value();
+    return false;
+  }
+  if (version != kCacheVersion) {
+    LOG(WARNING) << "Ignoring decomposition cache entry of version "
+                 << version << ": " << path.value();
+    return false;
+  }
+  if (entry_key != key) {
+    LOG(WARNING) << "Ignoring mismatched decomposition cache entry: "
+                 << path.value();
+    return false;
+  }
+
+  block_graph::BlockGraphSerializer::Attributes attributes = 0;
+  if (!LoadBlockGraphAndImageLayout(
+          pe_file, &attributes, image_layout, &in_archive)) {
+    LOG(ERROR) << "Unable to deserialize decomposition cache entry: "
+               << path.value();
+    return false;
+  }
+
+  return true;
+}
+
+bool DecompositionCache::Save(const PEFile& pe_file,
+                              const ImageLayout& image_layout) const {
+  std::string key;
+  if (!GetKey(pe_file, &key))
+    return false;
+  base::FilePath path = directory_.AppendASCII(key + kEntryExtension);
+
+  if (!base::CreateDirectory(directory_)) {
+    LOG(ERROR) << "Unable to create decomposition cache directory: "
+               << directory_.value();
+    return false;
+  }
+
+  base::FilePath temp_path;
+  if (!base::CreateTemporaryFileInDir(directory_, &temp_path)) {
+    LOG(ERROR) << "Unable to create temporary file in: "
+               << directory_.value();
+    return false;
+  }
+
+  bool written = false;
+  {
+    base::ScopedFILE file(base::OpenFile(temp_path, "wb"));
+    if (file.get() != NULL) {
+      core::FileOutStream file_stream(file.get());
+      core::BufferedOutStream out_stream(&file_stream);
+      core::NativeBinaryOutArchive out_archive(&out_stream);
+      written = out_archive.Save(kCacheVersion) &&
+          out_archive.Save(key) &&
+          SaveBlockGraphAndImageLayout(pe_file, 0, image_layout,
+                                       &out_archive) &&
+          out_archive.Flush();
+    }
+  }
+  if (!written) {
+    LOG(ERROR) << "Unable to write decomposition cache entry: "
+               << temp_path.value();
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  base::File::Error error;
+  if (!base::ReplaceFileW(temp_path, path, &error)) {
+    LOG(ERROR) << "Unable to move decomposition cache entry into place: "
+               << path.value();
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  return true;
+}
+
+bool DecompositionCache::Remove(const PEFile& pe_file) const {
+  base::FilePath path;
+  if (!GetEntryPath(pe_file, &path))
+    return false;
+  return base::DeleteFile(path, false);
+}
+
+}  // namespace pe
@@ -0,0 +1,88 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares an on-disk cache of PE image decompositions. A build pipeline
+// typically runs several tools over the same image, each of which decomposes
+// it anew; with the cache only the first of them pays for the decomposition.
+// Entries are keyed by the signature of the image and the GUID and age of its
+// PDB, and hold the serialized block graph and image layout.
+
+#ifndef SYZYGY_PE_DECOMPOSITION_CACHE_H_
+#define SYZYGY_PE_DECOMPOSITION_CACHE_H_
+
+#include <string>
+
+#include "base/files/file_path.h"
+#include "syzygy/pe/image_layout.h"
+#include "syzygy/pe/pe_file.h"
+
+namespace pe {
+
+class DecompositionCache {
+ public:
+  // The environment variable naming the cache directory used by default.
+  static const char kCacheDirectoryEnvVar[];
+
+  // @returns the cache directory named by kCacheDirectoryEnvVar, or an empty
+  //     path if it isn't set.
+  static base::FilePath GetDirectoryFromEnvironment();
+
+  // @param directory The directory holding the cache entries. It's created
+  //     on the first save if it doesn't exist yet.
+  explicit DecompositionCache(const base::FilePath& directory);
+
+  // Computes the key of the decomposition of an image.
+  // @param pe_file The image.
+  // @param key Receives the key.
+  // @returns true on success, false if the image has no PDB information.
+  static bool GetKey(const PEFile& pe_file, std::string* key);
+
+  // Computes the path of the cache entry of an image.
+  // @param pe_file The image.
+  // @param path Receives the path of the entry.
+  // @returns true on success, false otherwise.
+  bool GetEntryPath(const PEFile& pe_file, base::FilePath* path) const;
+
+  // Loads the decomposition of an image from the cache.
+  // @param pe_file The image. This must outlive @p image_layout.
+  // @param image_layout Receives the decomposition. Its block graph must be
+  //     empty. On failure it may be left partially populated.
+  // @returns true on success, false if there is no usable entry.
+  bool Load(const PEFile& pe_file, ImageLayout* image_layout) const;
+
+  // Saves the decomposition of an image to the cache, replacing any existing
+  // entry. The entry is written to a temporary file that is then moved into
+  // place, so concurrent readers never see a partial entry.
+  // @param pe_file The image.
+  // @param image_layout The decomposition of @p pe_file.
+  // @returns true on success, false otherwise.
+  bool Save(const PEFile& pe_file, const ImageLayout& image_layout) const;
+
+  // Removes the cache entry of an image, if any.
+  // @param pe_file The image.
+  // @returns true on success, false otherwise.
+  bool Remove(const PEFile& pe_file) const;
+
+  // @returns the directory holding the cache entries.
+  const base::FilePath& directory() const { return directory_; }
+
+ private:
+  base::FilePath directory_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecompositionCache);
+};
+
+}  // namespace pe
+
+#endif  // SYZYGY_PE_DECOMPOSITION_CACHE_H_
@@ -0,0 +1,122 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/decomposition_cache.h"
+
+#include "base/files/file_util.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/pe/decomposer.h"
+#include "syzygy/pe/unittest_util.h"
+
+namespace pe {
+
+namespace {
+
+using block_graph::BlockGraph;
+
+class DecompositionCacheTest : public testing::PELibUnitTest {
+  typedef testing::PELibUnitTest Super;
+
+ public:
+  void SetUp() override {
+    Super::SetUp();
+
+    ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir_));
+    cache_directory_ = temp_dir_.Append(L"cache");
+
+    base::FilePath image_path(
+        testing::GetExeRelativePath(testing::kTestDllName));
+    ASSERT_TRUE(image_file_.Init(image_path));
+  }
+
+  base::FilePath temp_dir_;
+  base::FilePath cache_directory_;
+  PEFile image_file_;
+};
+
+}  // namespace
+
+TEST_F(DecompositionCacheTest, GetKey) {
+  std::string key;
+  ASSERT_TRUE(DecompositionCache::GetKey(image_file_, &key));
+  EXPECT_FALSE(key.empty());
+
+  // The key is stable.
+  std::string key2;
+  ASSERT_TRUE(DecompositionCache::GetKey(image_file_, &key2));
+  EXPECT_EQ(key, key2);
+
+  DecompositionCache cache(cache_directory_);
+  EXPECT_EQ(cache_directory_, cache.directory());
+  base::FilePath path;
+  ASSERT_TRUE(cache.GetEntryPath(image_file_, &path));
+  EXPECT_EQ(cache_directory_, path.DirName());
+}
+
+TEST_F(DecompositionCacheTest, SaveAndLoad) {
+  DecompositionCache cache(cache_directory_);
+
+  // There's nothing to load from an empty cache.
+  BlockGraph missing_block_graph;
+  ImageLayout missing_image_layout(&missing_block_graph);
+  EXPECT_FALSE(cache.Load(image_file_, &missing_image_layout));
+  EXPECT_TRUE(missing_block_graph.blocks().empty());
+
+  Decomposer decomposer(image_file_);
+  decomposer.set_cache_directory(base::FilePath());
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  ASSERT_TRUE(cache.Save(image_file_, image_layout));
+  base::FilePath path;
+  ASSERT_TRUE(cache.GetEntryPath(image_file_, &path));
+  EXPECT_TRUE(base::PathExists(path));
+
+  BlockGraph loaded_block_graph;
+  ImageLayout loaded_image_layout(&loaded_block_graph);
+  ASSERT_TRUE(cache.Load(image_file_, &loaded_image_layout));
+  EXPECT_EQ(block_graph.blocks().size(), loaded_block_graph.blocks().size());
+  EXPECT_EQ(image_layout.sections.size(), loaded_image_layout.sections.size());
+  EXPECT_EQ(image_layout.blocks.size(), loaded_image_layout.blocks.size());
+
+  EXPECT_TRUE(cache.Remove(image_file_));
+  EXPECT_FALSE(base::PathExists(path));
+}
+
+TEST_F(DecompositionCacheTest, DecomposerPopulatesAndUsesCache) {
+  DecompositionCache cache(cache_directory_);
+  base::FilePath path;
+  ASSERT_TRUE(cache.GetEntryPath(image_file_, &path));
+
+  // The first decomposition populates the cache.
+  Decomposer decomposer(image_file_);
+  decomposer.set_cache_directory(cache_directory_);
+  BlockGraph block_graph;
+  ImageLayout image_layout(&block_graph);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+  EXPECT_TRUE(base::PathExists(path));
+
+  // The second one is read from it.
+  Decomposer cached_decomposer(image_file_);
+  cached_decomposer.set_cache_directory(cache_directory_);
+  BlockGraph cached_block_graph;
+  ImageLayout cached_image_layout(&cached_block_graph);
+  ASSERT_TRUE(cached_decomposer.Decompose(&cached_image_layout));
+  EXPECT_EQ(block_graph.blocks().size(), cached_block_graph.blocks().size());
+  EXPECT_EQ(image_layout.blocks.size(), cached_image_layout.blocks.size());
+}
+
+}  // namespace pe
@@ -14,6 +14,8 @@
 //
 #include "syzygy/pe/dia_browser.h"
 
+#include <algorithm>
+
 #include "base/logging.h"
 
 namespace {
@@ -102,6 +104,25 @@ struct DiaBrowser::PatternElement {
       outgoing_sym_tags |= links[i]->sym_tags;
   }
 
+  // Compiles the links of this element into a transition table indexed by
+  // sym_tag, so that advancing the search front doesn't have to test every
+  // link against every symbol.
+  void CalculateLinksBySymTag() {
+    for (size_t i = 0; i < kSymTagCount; ++i) {
+      links_by_sym_tag[i].clear();
+      for (size_t j = 0; j < links.size(); ++j) {
+        if (links[j]->sym_tags.test(i))
+          links_by_sym_tag[i].push_back(links[j]);
+      }
+    }
+  }
+
+  // Returns the links that match @p sym_tag.
+  const std::vector<PatternElement*>& LinksFor(SymTag sym_tag) const {
+    DCHECK(sym_tag >= kSymTagBegin && sym_tag < kSymTagEnd);
+    return links_by_sym_tag[sym_tag - kSymTagBegin];
+  }
+
   // The set of symbols that may be matched at this node.
   SymTagBitSet sym_tags;
 
@@ -111,6 +132,10 @@ struct DiaBrowser::PatternElement {
   // These are links to other PatternElements in the same pattern.
   std::vector<PatternElement*> links;
 
+  // The links above, by the sym_tag they match. Populated by
+  // CalculateLinksBySymTag.
+  std::vector<PatternElement*> links_by_sym_tag[kSymTagCount];
+
   // This indicates to which pattern this element belongs.
   // TODO(chrisha): Maybe a separate category_id for visited_ bookkeeping?
   size_t pattern_id;
@@ -511,10 +536,11 @@ bool DiaBrowser::AddPattern(const builder::Proxy& pattern_builder_proxy,
   }
 
   // Label the pattern node with the id of this pattern, and precalculate
-  // outgoing sym_tagsets as used by Browse.
+  // outgoing sym_tagsets and transitions as used by Browse.
   for (size_t i = 0; i < pattern_length; ++i) {
     pattern[i].pattern_id = pattern_id;
     pattern[i].CalculateOutgoingSymtags();
+    pattern[i].CalculateLinksBySymTag();
   }
 
   patterns_.push_back(pattern.release());
@@ -542,15 +568,11 @@ size_t DiaBrowser::TestMatch(const SymTagVector& sym_tags) const {
       for (size_t active_idx = 0; active_idx < active->size(); ++active_idx) {
         const PatternElement* elem = (*active)[active_idx];
 
-        if (elem->links.size() == 0 ||
-            !SymTagBitSetContains(elem->outgoing_sym_tags, sym_tag))
+        if (!SymTagBitSetContains(elem->outgoing_sym_tags, sym_tag))
           continue;
 
-        for (size_t link_idx = 0; link_idx < elem->links.size(); ++link_idx) {
-          const PatternElement* elem_next = elem->links[link_idx];
-          if (elem_next->Matches(sym_tag))
-            next->push_back(elem_next);
-        }
+        const std::vector<PatternElement*>& links = elem->LinksFor(sym_tag);
+        next->insert(next->end(), links.begin(), links.end());
       }
 
       std::swap(active, next);
@@ -587,6 +609,7 @@ void DiaBrowser::PrepareForBrowse() {
 
 void DiaBrowser::Reset() {
   visited_.clear();
+  child_cache_.clear();
   tag_lineage_.clear();
   symbol_lineage_.clear();
   front_.clear();
@@ -613,12 +636,10 @@ DiaBrowser::BrowserDirective DiaBrowser::PushMatch(SymTag sym_tag,
     if (stopped_[patid])
       continue;
 
-    // Iterate over the possible destinations of this element.
-    for (size_t l = 0; l < front_[f]->links.size(); ++l) {
-      PatternElement* elem = front_[f]->links[l];
-
-      if (!elem->Matches(sym_tag))
-        continue;
+    // Iterate over the destinations of this element that match.
+    const std::vector<PatternElement*>& links = front_[f]->LinksFor(sym_tag);
+    for (size_t l = 0; l < links.size(); ++l) {
+      PatternElement* elem = links[l];
 
       // Each element will only be visited once per pattern element.
       if (!visited_.insert(std::make_pair(elem, symbol_id)).second)
@@ -652,7 +673,7 @@ DiaBrowser::BrowserDirective DiaBrowser::PushMatch(SymTag sym_tag,
         // search front, and mark the pattern as stopped.
         case kBrowserTerminatePattern:
           stopped_[patid] = true;
-          l = front_[f]->links.size();
+          l = links.size();
           need_pop_callback = true;
           break;
 
@@ -736,13 +757,21 @@ DiaBrowser::BrowserDirective DiaBrowser::PopMatch(bool do_callbacks) {
 }
 
 bool DiaBrowser::Browse(IDiaSymbol* root) {
+  DWORD root_id = 0;
+  HRESULT hr = root->get_symIndexId(&root_id);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "Failed to get DIA root symbol ID: " << hr << ".";
+    return false;
+  }
+
   PrepareForBrowse();
-  BrowserDirective directive = BrowseImpl(root, 0);
+  BrowserDirective directive = BrowseImpl(root, root_id, 0);
   Reset();
   return directive != kBrowserAbort;
 }
 
 DiaBrowser::BrowserDirective DiaBrowser::BrowseImpl(IDiaSymbol* root,
+                                                    uint32_t root_id,
                                                     size_t depth) {
   if (sym_tags_[depth].none())
     return kBrowserContinue;
@@ -751,55 +780,96 @@ DiaBrowser::BrowserDirective DiaBrowser::BrowseImpl(IDiaSymbol* root,
   if (sym_tags_.size() < depth + 2)
     sym_tags_.resize(depth + 2);
 
-  // If all symbols are accepted, we can use SymTagNull as a wildcard rather
-  // than iterating over each individual SymTag.
-  if (sym_tags_[depth].count() == sym_tags_[depth].size())
-    return BrowseEnum(root, depth, SymTagNull);
+  const ChildList* child_list = GetChildren(root, root_id);
+  if (child_list == NULL)
+    return kBrowserAbort;
 
-  // Iterate through all possible symbol tags that can be matched.
-  for (size_t i = 0; i < kSymTagCount; ++i) {
-    if (!sym_tags_[depth].test(i))
-      continue;
-    SymTag sym_tag = static_cast<SymTag>(kSymTagBegin + i);
-    BrowserDirective directive = BrowseEnum(root, depth, sym_tag);
-    if (directive == kBrowserTerminateAll || directive == kBrowserAbort)
-      return directive;
+  BrowserDirective directive = kBrowserContinue;
+  tag_lineage_.push_back(SymTagNull);
+  symbol_lineage_.push_back(SymbolPtr());
+
+  if (sym_tags_[depth].count() == sym_tags_[depth].size()) {
+    // If all symbols are accepted, visit them in the order DIA returns them,
+    // as a SymTagNull wildcard enumeration would.
+    for (size_t i = 0; i < child_list->children.size(); ++i) {
+      directive = BrowseChild(child_list->children[i], depth);
+      if (directive != kBrowserContinue)
+        break;
+    }
+  } else {
+    // Otherwise visit the symbols of each tag that can be matched in turn.
+    for (size_t i = 0; i < kSymTagCount; ++i) {
+      if (!sym_tags_[depth].test(i))
+        continue;
+      size_t end = child_list->tag_begin[i + 1];
+      for (size_t j = child_list->tag_begin[i]; j < end; ++j) {
+        size_t child = child_list->by_sym_tag[j];
+        directive = BrowseChild(child_list->children[child], depth);
+        if (directive != kBrowserContinue)
+          break;
+      }
+      if (directive != kBrowserContinue)
+        break;
+    }
   }
 
-  return kBrowserContinue;
+  tag_lineage_.pop_back();
+  symbol_lineage_.pop_back();
+
+  return directive;
 }
 
-DiaBrowser::BrowserDirective DiaBrowser::BrowseEnum(
-    IDiaSymbol* root, size_t depth, SymTag sym_tag) {
-  // Get the enum for this symbol type
+DiaBrowser::BrowserDirective DiaBrowser::BrowseChild(const ChildSymbol& child,
+                                                     size_t depth) {
+  tag_lineage_.back() = child.sym_tag;
+  symbol_lineage_.back() = child.symbol;
+
+  // Try to extend the match using this symbol. If this succeeds, recurse.
+  BrowserDirective directive = PushMatch(child.sym_tag,
+                                         child.symbol_id,
+                                         &sym_tags_[depth + 1]);
+  if (directive == kBrowserContinue)
+    directive = BrowseImpl(child.symbol.get(), child.symbol_id, depth + 1);
+  if (directive == kBrowserTerminateAll || directive == kBrowserAbort) {
+    // We've terminated the search already, so we don't need to invoke the
+    // pop callbacks.
+    PopMatch(false);
+    return directive;
+  }
+
+  // Roll back the search front, and terminate the search if need be.
+  return PopMatch(true);
+}
+
+const DiaBrowser::ChildList* DiaBrowser::GetChildren(IDiaSymbol* root,
+                                                     uint32_t root_id) {
+  std::map<uint32_t, ChildList>::iterator it = child_cache_.find(root_id);
+  if (it != child_cache_.end())
+    return &it->second;
+
+  // Get an enum of all the children, of any symbol type.
   ScopedComPtr<IDiaEnumSymbols> enum_symbols;
-  HRESULT hr = root->findChildren(sym_tag,
+  HRESULT hr = root->findChildren(SymTagNull,
                                   NULL,
                                   nsNone,
                                   enum_symbols.Receive());
   if (FAILED(hr)) {
     LOG(ERROR) << "Failed to get DIA symbol enumerator: " << hr << ".";
-    return kBrowserAbort;
+    return NULL;
   }
 
+  ChildList& child_list = child_cache_[root_id];
+
   // Sometimes a NULL enum gets returned rather than an empty
   // enum. (Why?)
-  if (enum_symbols.get() == NULL)
-    return kBrowserContinue;
-
-  BrowserDirective directive = kBrowserContinue;
-  tag_lineage_.push_back(SymTagNull);
-  symbol_lineage_.push_back(SymbolPtr());
-
-  // Iterate through the returned symbols.
-  while (true) {
-    SymbolPtr symbol;
+  while (enum_symbols.get() != NULL) {
+    ChildSymbol child;
     ULONG fetched = 0;
-    hr = enum_symbols->Next(1, symbol.Receive(), &fetched);
+    hr = enum_symbols->Next(1, child.symbol.Receive(), &fetched);
     if (FAILED(hr)) {
       LOG(ERROR) << "Failed to enumerate DIA symbols: " << hr << ".";
-      directive = kBrowserAbort;
-      break;
+      child_cache_.erase(root_id);
+      return NULL;
     }
     // No more symbols?
     if (fetched == 0)
@@ -807,41 +877,44 @@ DiaBrowser::BrowserDirective DiaBrowser::BrowseEnum(
 
     // Get the symbol ID and tag type.
     DWORD symbol_id = 0;
-    DWORD actual_sym_tag_dw = SymTagNull;
-    if (FAILED(symbol->get_symIndexId(&symbol_id)) ||
-        FAILED(symbol->get_symTag(&actual_sym_tag_dw))) {
+    DWORD sym_tag = SymTagNull;
+    if (FAILED(child.symbol->get_symIndexId(&symbol_id)) ||
+        FAILED(child.symbol->get_symTag(&sym_tag))) {
       NOTREACHED() << "Failed to get symbol properties.";
-      directive = kBrowserAbort;
-      break;
+      child_cache_.erase(root_id);
+      return NULL;
     }
-    SymTag actual_sym_tag = static_cast<SymTag>(actual_sym_tag_dw);
-    if (sym_tag != SymTagNull)
-      DCHECK_EQ(sym_tag, actual_sym_tag);
-
-    tag_lineage_.back() = actual_sym_tag;
-    symbol_lineage_.back() = symbol;
-
-    // Try to extend the match using this symbol. If this succeeds, recurse.
-    directive = PushMatch(actual_sym_tag, symbol_id, &sym_tags_[depth + 1]);
-    if (directive == kBrowserContinue)
-      directive = BrowseImpl(symbol.get(), depth + 1);
-    if (directive == kBrowserTerminateAll || directive == kBrowserAbort) {
-      // We've terminated the search already, so we don't need to invoke the
-      // pop callbacks.
-      PopMatch(false);
-      break;
+
+    // Symbols with tags outside of the SymTagEnum range can't be matched.
+    if (sym_tag < static_cast<DWORD>(kSymTagBegin) ||
+        sym_tag >= static_cast<DWORD>(kSymTagEnd)) {
+      continue;
     }
 
-    // Roll back the search front, and terminate the search if need be.
-    directive = PopMatch(true);
-    if (directive == kBrowserTerminateAll || directive == kBrowserAbort)
-      break;
+    child.symbol_id = symbol_id;
+    child.sym_tag = static_cast<SymTag>(sym_tag);
+    child_list.children.push_back(child);
   }
 
-  tag_lineage_.pop_back();
-  symbol_lineage_.pop_back();
+  // Index the children by tag, preserving the order of the children of each
+  // tag. This is a counting sort.
+  std::fill(child_list.tag_begin,
+            child_list.tag_begin + kSymTagCount + 1,
+            0);
+  for (size_t i = 0; i < child_list.children.size(); ++i)
+    ++child_list.tag_begin[child_list.children[i].sym_tag - kSymTagBegin + 1];
+  for (size_t i = 0; i < kSymTagCount; ++i)
+    child_list.tag_begin[i + 1] += child_list.tag_begin[i];
+
+  std::vector<size_t> next_index(child_list.tag_begin,
+                                 child_list.tag_begin + kSymTagCount);
+  child_list.by_sym_tag.resize(child_list.children.size());
+  for (size_t i = 0; i < child_list.children.size(); ++i) {
+    size_t tag_index = child_list.children[i].sym_tag - kSymTagBegin;
+    child_list.by_sym_tag[next_index[tag_index]++] = i;
+  }
 
-  return directive;
+  return &child_list;
 }
 
 namespace builder {
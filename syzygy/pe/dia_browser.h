@@ -32,6 +32,7 @@
 #include <limits.h>
 #include <windows.h>
 #include <bitset>
+#include <map>
 #include <memory>
 #include <set>
 #include <utility>
@@ -173,16 +174,45 @@ class DiaBrowser {
   // This rolls back our search stack by one level, calling pop callbacks.
   DiaBrowser::BrowserDirective PopMatch(bool do_callbacks);
 
+  // An immediate descendant of a symbol.
+  struct ChildSymbol {
+    SymbolPtr symbol;
+    uint32_t symbol_id;
+    SymTag sym_tag;
+  };
+
+  // The immediate descendants of a symbol, as enumerated by a single call to
+  // findChildren. The symbols are stored in the order DIA returns them, and
+  // are indexed by sym_tag so that a subset of tags can be visited without
+  // enumerating the symbol again.
+  struct ChildList {
+    std::vector<ChildSymbol> children;
+    // Indices into children, sorted by sym_tag. The symbols with the tag
+    // kSymTagBegin + i are at by_sym_tag[tag_begin[i]] up to
+    // by_sym_tag[tag_begin[i + 1]].
+    std::vector<size_t> by_sym_tag;
+    size_t tag_begin[kSymTagCount + 1];
+  };
+
   // The actual implementation of Browse, modulo some startup stuff.
   // This can return a reduced subset of BrowserDirective, namely:
   // kBrowserContinue, kBrowserTerminateAll, or kBrowserAbort.
-  BrowserDirective BrowseImpl(IDiaSymbol* root, size_t depth);
+  BrowserDirective BrowseImpl(IDiaSymbol* root,
+                              uint32_t root_id,
+                              size_t depth);
 
-  // This iterates all symbols with symbol tag @p sym_tag that are immediate
-  // descendants of @p root.
+  // Tries to extend the search with @p child, an immediate descendant of the
+  // symbol at @p depth, recursing into it if it matches.
   // This can return a reduced subset of BrowserDirective, namely:
   // kBrowserContinue, kBrowserTerminateAll, or kBrowserAbort.
-  BrowserDirective BrowseEnum(IDiaSymbol* root, size_t depth, SymTag sym_tag);
+  BrowserDirective BrowseChild(const ChildSymbol& child, size_t depth);
+
+  // Gets the immediate descendants of @p root, enumerating them the first
+  // time they're requested during a browse and caching them afterwards.
+  // @param root The symbol whose children are requested.
+  // @param root_id The ID of @p root.
+  // @returns the children of @p root, or NULL on error.
+  const ChildList* GetChildren(IDiaSymbol* root, uint32_t root_id);
 
   // The set of visited nodes. The first parameter is the address of the
   // element that matched, the second is the actual ID of the visited node.
@@ -192,6 +222,12 @@ class DiaBrowser {
   // TODO(chrisha): Use a hash_map here instead, to minimize allocations?
   std::set<std::pair<const PatternElement*, uint32_t> > visited_;
 
+  // The children of the symbols enumerated so far during a browse, by symbol
+  // ID. Types in particular are reachable along many paths, and each of those
+  // would otherwise create its own DIA enumerators. Entries are never erased
+  // during a browse, so pointers to them remain valid while recursing.
+  std::map<uint32_t, ChildList> child_cache_;
+
   // The search patterns we're using. All patterns stored here must be valid.
   // We manually manage memory because we require a 'delete []' to be called
   // on each pattern, something which scoped_array does not do. Similarly,
@@ -422,6 +422,25 @@ TEST_F(DiaBrowserTest, AllDataSymbolsExploredWithPopCallbacks) {
   dia_browser.Browse(global_.get());
 }
 
+TEST_F(DiaBrowserTest, AllPatternsMatchedInOneBrowse) {
+  TestDiaBrowser dia_browser;
+
+  // Every symbol matched by either pattern is dispatched to its callback.
+  dia_browser.AddPattern(Tag(SymTagCompiland), on_full_match_);
+  dia_browser.AddPattern(Seq(Star(SymTagNull), SymTagData),
+                         on_full_match_);
+
+  EXPECT_CALL(*this, OnFullMatch(_, _, _)).Times(154 + 2896).
+      WillRepeatedly(Return(DiaBrowser::kBrowserContinue));
+  EXPECT_TRUE(dia_browser.Browse(global_.get()));
+
+  // The child cache doesn't outlive a browse, so browsing again yields the
+  // same matches.
+  EXPECT_CALL(*this, OnFullMatch(_, _, _)).Times(154 + 2896).
+      WillRepeatedly(Return(DiaBrowser::kBrowserContinue));
+  EXPECT_TRUE(dia_browser.Browse(global_.get()));
+}
+
 TEST_F(DiaBrowserTest, SomePathsTerminated) {
   TestDiaBrowser dia_browser;
 
@@ -18,13 +18,23 @@
 
 #include "syzygy/pe/find.h"
 
+#include <algorithm>
+
+#include "base/atomicops.h"
+#include "base/bind.h"
 #include "base/environment.h"
+#include "base/lazy_instance.h"
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/json/json_reader.h"
 #include "base/strings/string_split.h"
+#include "base/strings/stringprintf.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/threading/simple_thread.h"
+#include "base/values.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/common/dbghelp_util.h"
+#include "syzygy/core/json_file_writer.h"
 #include "syzygy/pdb/pdb_util.h"
 #include "syzygy/pe/pdb_info.h"
 #include "syzygy/pe/pe_data.h"
@@ -34,6 +44,133 @@ namespace pe {
 
 namespace {
 
+// The process-wide cache of found files.
+base::LazyInstance<FindCache>::Leaky g_find_cache = LAZY_INSTANCE_INITIALIZER;
+
+// DbgHelp is single-threaded, so concurrent searches take turns using it.
+base::LazyInstance<base::Lock>::Leaky g_dbghelp_lock =
+    LAZY_INSTANCE_INITIALIZER;
+
+// Searches for a single file. Returns false if the search fails in error.
+typedef base::Callback<bool(size_t)> FindOneCallback;
+
+// Runs a search for each of a list of files, possibly on worker threads. Each
+// work item searches for one file.
+class FindWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  FindWork(size_t count, const FindOneCallback& find_one)
+      : count_(count), find_one_(find_one), next_index_(0), failed_(0) {
+  }
+
+  size_t work_items() const { return count_; }
+
+  // @returns true if any search failed in error.
+  bool failed() const { return base::subtle::Acquire_Load(&failed_) != 0; }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, count_);
+    if (!failed() && !find_one_.Run(index))
+      base::subtle::Release_Store(&failed_, 1);
+  }
+  // @}
+
+ private:
+  size_t count_;
+  FindOneCallback find_one_;
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(FindWork);
+};
+
+bool RunFindWork(size_t num_threads, FindWork* work) {
+  DCHECK_LT(0u, num_threads);
+  DCHECK(work != NULL);
+
+  size_t work_items = work->work_items();
+  if (num_threads <= 1 || work_items <= 1) {
+    for (size_t i = 0; i < work_items && !work->failed(); ++i)
+      work->Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "FindFiles", static_cast<int>(std::min(num_threads, work_items)));
+    pool.Start();
+    pool.AddWork(work, static_cast<int>(work_items));
+    pool.JoinAll();
+  }
+
+  return !work->failed();
+}
+
+bool FindModuleAt(const std::vector<PEFile::Signature>* module_signatures,
+                  const std::wstring& search_paths,
+                  std::vector<base::FilePath>* module_paths,
+                  size_t index) {
+  (*module_paths)[index].clear();
+  return FindModuleBySignature((*module_signatures)[index],
+                               search_paths,
+                               &(*module_paths)[index]);
+}
+
+bool FindPdbAt(const std::vector<base::FilePath>* module_paths,
+               const std::wstring& search_paths,
+               std::vector<base::FilePath>* pdb_paths,
+               size_t index) {
+  (*pdb_paths)[index].clear();
+  return FindPdbForModule((*module_paths)[index],
+                          search_paths,
+                          &(*pdb_paths)[index]);
+}
+
+// Appends the fields of a cache key that every search depends on: the hint,
+// the search paths and the working directory, which is searched as ".".
+void AppendCommonCacheKey(const base::FilePath& hint,
+                          const base::StringPiece16& search_paths,
+                          std::wstring* key) {
+  DCHECK(key != NULL);
+
+  base::FilePath current_dir;
+  base::GetCurrentDirectory(&current_dir);
+
+  key->push_back(L'|');
+  key->append(hint.value());
+  key->push_back(L'|');
+  key->append(search_paths.begin(), search_paths.end());
+  key->push_back(L'|');
+  key->append(current_dir.value());
+}
+
+std::wstring GetModuleCacheKey(const PEFile::Signature& module_signature,
+                               const base::FilePath& hint,
+                               const base::StringPiece16& search_paths) {
+  // The search only depends on the name of the module, its size and its time
+  // stamp.
+  std::wstring key(base::StringPrintf(
+      L"module|%08X%08X|",
+      module_signature.module_time_date_stamp,
+      static_cast<uint32_t>(module_signature.module_size)));
+  key.append(module_signature.path);
+  AppendCommonCacheKey(hint, search_paths, &key);
+  return key;
+}
+
+std::wstring GetPdbCacheKey(const PdbInfo& pdb_info,
+                            const base::FilePath& hint,
+                            const base::StringPiece16& search_paths) {
+  wchar_t guid[40] = {};
+  ::StringFromGUID2(pdb_info.signature(), guid, arraysize(guid));
+  std::wstring key(base::StringPrintf(L"pdb|%ls%08X|",
+                                      guid,
+                                      pdb_info.pdb_age()));
+  key.append(pdb_info.pdb_file_name().value());
+  AppendCommonCacheKey(hint, search_paths, &key);
+  return key;
+}
+
 bool GetEnvVar(const char* name, std::wstring* value) {
   DCHECK(name != NULL);
   DCHECK(value != NULL);
@@ -112,6 +249,18 @@ bool FindFile(const base::FilePath& file_path,
 
   found_file->clear();
 
+  // The file is first looked for at its own path, which is the first place
+  // the search below would look. When it's there this saves going through
+  // DbgHelp, and doesn't need to wait for other searches to be done with it.
+  if (base::PathExists(file_path) &&
+      callback(file_path.value().c_str(), callback_context) == FALSE) {
+    *found_file = base::MakeAbsoluteFilePath(file_path);
+    if (!found_file->empty())
+      return true;
+  }
+
+  base::AutoLock auto_lock(g_dbghelp_lock.Get());
+
   // Make a unique "handle" for this use of the symbolizer.
   HANDLE unique_handle = &unique_handle;
   if (!common::SymInitialize(unique_handle, NULL, false))
@@ -184,6 +333,21 @@ bool FindModuleBySignature(const PEFile::Signature& module_signature,
                            base::FilePath* module_path) {
   DCHECK(module_path != NULL);
 
+  // Reuse the result of an earlier search if it still matches.
+  FindCache* cache = FindCache::Get();
+  std::wstring key(
+      GetModuleCacheKey(module_signature, *module_path, search_paths));
+  base::FilePath cached_path;
+  if (cache->Lookup(key, &cached_path)) {
+    if (FindPeFileCallback(cached_path.value().c_str(),
+                           const_cast<PEFile::Signature*>(&module_signature)) ==
+            FALSE) {
+      *module_path = cached_path;
+      return true;
+    }
+    cache->Erase(key);
+  }
+
   std::vector<base::FilePath> candidate_paths;
   if (!module_path->empty())
     candidate_paths.push_back(*module_path);
@@ -208,8 +372,10 @@ bool FindModuleBySignature(const PEFile::Signature& module_signature,
     }
 
     // If the search was successful we can terminate early.
-    if (!module_path->empty())
+    if (!module_path->empty()) {
+      cache->Insert(key, *module_path);
       return true;
+    }
   }
   DCHECK(module_path->empty());
 
@@ -248,6 +414,18 @@ bool FindPdbForModule(const base::FilePath& module_path,
   search_path.append(L";");
   search_path.append(search_paths.begin(), search_paths.end());
 
+  // Reuse the result of an earlier search if it still matches.
+  FindCache* cache = FindCache::Get();
+  std::wstring key(GetPdbCacheKey(pdb_info, *pdb_path, search_path));
+  base::FilePath cached_path;
+  if (cache->Lookup(key, &cached_path)) {
+    if (FindPdbFileCallback(cached_path.value().c_str(), &pdb_info) == FALSE) {
+      *pdb_path = cached_path;
+      return true;
+    }
+    cache->Erase(key);
+  }
+
   for (size_t i = 0; i < candidate_paths.size(); ++i) {
     const base::FilePath& path = candidate_paths[i];
 
@@ -263,8 +441,10 @@ bool FindPdbForModule(const base::FilePath& module_path,
     }
 
     // If the search was successful we can terminate early.
-    if (!pdb_path->empty())
+    if (!pdb_path->empty()) {
+      cache->Insert(key, *pdb_path);
       return true;
+    }
   }
   DCHECK(pdb_path->empty());
 
@@ -284,4 +464,163 @@ bool FindPdbForModule(const base::FilePath& module_path,
                           pdb_path);
 }
 
+bool FindModulesBySignature(
+    const std::vector<PEFile::Signature>& module_signatures,
+    const base::StringPiece16& search_paths,
+    size_t num_threads,
+    std::vector<base::FilePath>* module_paths) {
+  DCHECK(module_paths != NULL);
+
+  module_paths->clear();
+  module_paths->resize(module_signatures.size());
+  FindWork work(module_signatures.size(),
+                base::Bind(&FindModuleAt,
+                           base::Unretained(&module_signatures),
+                           search_paths.as_string(),
+                           base::Unretained(module_paths)));
+  return RunFindWork(num_threads, &work);
+}
+
+bool FindModulesBySignature(
+    const std::vector<PEFile::Signature>& module_signatures,
+    size_t num_threads,
+    std::vector<base::FilePath>* module_paths) {
+  DCHECK(module_paths != NULL);
+
+  std::wstring search_paths;
+  if (!GetEnvVar("PATH", &search_paths))
+    return false;
+
+  return FindModulesBySignature(module_signatures,
+                                search_paths,
+                                num_threads,
+                                module_paths);
+}
+
+bool FindPdbsForModules(const std::vector<base::FilePath>& module_paths,
+                        const base::StringPiece16& search_paths,
+                        size_t num_threads,
+                        std::vector<base::FilePath>* pdb_paths) {
+  DCHECK(pdb_paths != NULL);
+
+  pdb_paths->clear();
+  pdb_paths->resize(module_paths.size());
+  FindWork work(module_paths.size(),
+                base::Bind(&FindPdbAt,
+                           base::Unretained(&module_paths),
+                           search_paths.as_string(),
+                           base::Unretained(pdb_paths)));
+  return RunFindWork(num_threads, &work);
+}
+
+bool FindPdbsForModules(const std::vector<base::FilePath>& module_paths,
+                        size_t num_threads,
+                        std::vector<base::FilePath>* pdb_paths) {
+  DCHECK(pdb_paths != NULL);
+
+  std::wstring search_paths;
+  if (!GetEnvVar("_NT_SYMBOL_PATH", &search_paths))
+    return false;
+
+  return FindPdbsForModules(module_paths,
+                            search_paths,
+                            num_threads,
+                            pdb_paths);
+}
+
+FindCache::FindCache() {
+}
+
+FindCache::~FindCache() {
+}
+
+FindCache* FindCache::Get() {
+  return g_find_cache.Pointer();
+}
+
+bool FindCache::Lookup(const std::wstring& key, base::FilePath* path) const {
+  DCHECK(path != NULL);
+
+  base::AutoLock auto_lock(lock_);
+  EntryMap::const_iterator it = entries_.find(key);
+  if (it == entries_.end())
+    return false;
+  *path = it->second;
+  return true;
+}
+
+void FindCache::Insert(const std::wstring& key, const base::FilePath& path) {
+  base::AutoLock auto_lock(lock_);
+  entries_[key] = path;
+}
+
+void FindCache::Erase(const std::wstring& key) {
+  base::AutoLock auto_lock(lock_);
+  entries_.erase(key);
+}
+
+void FindCache::Clear() {
+  base::AutoLock auto_lock(lock_);
+  entries_.clear();
+}
+
+size_t FindCache::size() const {
+  base::AutoLock auto_lock(lock_);
+  return entries_.size();
+}
+
+bool FindCache::Load(const base::FilePath& path) {
+  if (!base::PathExists(path))
+    return true;
+
+  std::string json;
+  if (!base::ReadFileToString(path, &json)) {
+    LOG(ERROR) << "Unable to read find cache: " << path.value();
+    return false;
+  }
+
+  std::unique_ptr<base::Value> value(base::JSONReader::Read(json).release());
+  base::DictionaryValue* dict = NULL;
+  if (value.get() == NULL || !value->GetAsDictionary(&dict)) {
+    LOG(ERROR) << "Invalid find cache: " << path.value();
+    return false;
+  }
+
+  base::AutoLock auto_lock(lock_);
+  for (base::DictionaryValue::Iterator it(*dict); !it.IsAtEnd();
+       it.Advance()) {
+    base::string16 entry_path;
+    if (!it.value().GetAsString(&entry_path)) {
+      LOG(ERROR) << "Invalid find cache entry in " << path.value() << ".";
+      return false;
+    }
+    entries_[base::UTF8ToWide(it.key())] = base::FilePath(entry_path);
+  }
+
+  return true;
+}
+
+bool FindCache::Save(const base::FilePath& path) const {
+  base::ScopedFILE file(base::OpenFile(path, "wb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to create find cache: " << path.value();
+    return false;
+  }
+
+  base::AutoLock auto_lock(lock_);
+  core::JSONFileWriter json_file(file.get(), true);
+  bool success = json_file.OpenDict();
+  for (EntryMap::const_iterator it = entries_.begin();
+       success && it != entries_.end(); ++it) {
+    success = json_file.OutputKey(it->first) &&
+        json_file.OutputString(it->second.value());
+  }
+  if (!success || !json_file.CloseDict() || !json_file.Flush()) {
+    LOG(ERROR) << "Unable to write find cache: " << path.value();
+    return false;
+  }
+
+  return true;
+}
+
 }  // namespace pe
@@ -18,8 +18,14 @@
 #ifndef SYZYGY_PE_FIND_H_
 #define SYZYGY_PE_FIND_H_
 
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
 #include "base/files/file_path.h"
 #include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/pe/pe_file.h"
 
 namespace pe {
@@ -98,6 +104,110 @@ bool FindPdbForModule(const base::FilePath& module_path,
 bool FindPdbForModule(const base::FilePath& module_path,
                       base::FilePath* pdb_path);
 
+// Looks for the modules matching many module signatures, as
+// FindModuleBySignature does for one of them, resolving several at once.
+//
+// @param module_signatures The signatures of the modules we are searching for.
+// @param search_paths A semi-colon separated list of additional search paths.
+// @param num_threads The number of threads to search on. Must be at least 1.
+// @param module_paths Will receive the absolute path of each discovered
+//     module, or an empty path for each module that isn't found.
+// @returns false if any errors occur, true otherwise.
+bool FindModulesBySignature(
+    const std::vector<PEFile::Signature>& module_signatures,
+    const base::StringPiece16& search_paths,
+    size_t num_threads,
+    std::vector<base::FilePath>* module_paths);
+
+// Same as 4-parameter FindModulesBySignature, but uses the PATH environment
+// variable as the list of search paths.
+bool FindModulesBySignature(
+    const std::vector<PEFile::Signature>& module_signatures,
+    size_t num_threads,
+    std::vector<base::FilePath>* module_paths);
+
+// Searches for the PDB files corresponding to many modules, as
+// FindPdbForModule does for one of them, resolving several at once.
+//
+// @param module_paths The modules whose PDB files we are looking for.
+// @param search_paths A semi-colon separated list of additional search paths.
+//     May use the svr* and cache* notation of symbol servers.
+// @param num_threads The number of threads to search on. Must be at least 1.
+// @param pdb_paths Will receive the absolute path of each discovered PDB file,
+//     or an empty path for each PDB file that isn't found.
+// @returns false if any errors occur, true otherwise.
+bool FindPdbsForModules(const std::vector<base::FilePath>& module_paths,
+                        const base::StringPiece16& search_paths,
+                        size_t num_threads,
+                        std::vector<base::FilePath>* pdb_paths);
+
+// Same as 4-parameter FindPdbsForModules, but uses the _NT_SYMBOL_PATH
+// environment variable as the list of search paths.
+bool FindPdbsForModules(const std::vector<base::FilePath>& module_paths,
+                        size_t num_threads,
+                        std::vector<base::FilePath>* pdb_paths);
+
+// A cache of the files found by FindModuleBySignature and FindPdbForModule.
+// Tools that process traces look up the same modules over and over, and
+// searching symbol paths, symbol servers in particular, is slow. Entries are
+// keyed by everything a search depends on: the signature sought, the hint,
+// the search paths and the working directory. A cached file is checked
+// against the signature again before being returned, so a stale entry only
+// costs a search. Failed searches aren't cached.
+//
+// A process-wide cache is always in use. It can be saved to a file and loaded
+// back so that it persists across runs.
+class FindCache {
+ public:
+  FindCache();
+  ~FindCache();
+
+  // @returns the process-wide cache.
+  static FindCache* Get();
+
+  // Looks up an entry.
+  // @param key The key of the entry.
+  // @param path Receives the path of the entry.
+  // @returns true if the entry exists, false otherwise.
+  bool Lookup(const std::wstring& key, base::FilePath* path) const;
+
+  // Adds or replaces an entry.
+  // @param key The key of the entry.
+  // @param path The path of the entry.
+  void Insert(const std::wstring& key, const base::FilePath& path);
+
+  // Removes an entry, if it exists.
+  // @param key The key of the entry.
+  void Erase(const std::wstring& key);
+
+  // Removes all entries.
+  void Clear();
+
+  // @returns the number of entries.
+  size_t size() const;
+
+  // Adds the entries of a file written by Save to the cache. A missing file
+  // isn't an error, so that the first run of a tool can create it.
+  // @param path The path of the file.
+  // @returns true on success, false otherwise.
+  bool Load(const base::FilePath& path);
+
+  // Writes the entries to a file, as JSON.
+  // @param path The path of the file.
+  // @returns true on success, false otherwise.
+  bool Save(const base::FilePath& path) const;
+
+ private:
+  typedef std::map<std::wstring, base::FilePath> EntryMap;
+
+  // Protects entries_. Searches are run concurrently by
+  // FindModulesBySignature and FindPdbsForModules.
+  mutable base::Lock lock_;
+  EntryMap entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(FindCache);
+};
+
 }  // namespace pe
 
 #endif  // SYZYGY_PE_FIND_H_
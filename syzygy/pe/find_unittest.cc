@@ -14,6 +14,10 @@
 
 #include "syzygy/pe/find.h"
 
+#include "base/files/file_util.h"
+#include "base/json/json_reader.h"
+#include "base/json/json_writer.h"
+#include "base/values.h"
 #include "base/win/scoped_handle.h"
 #include "gtest/gtest.h"
 #include "syzygy/common/com_utils.h"
@@ -26,7 +30,16 @@ namespace pe {
 namespace {
 
 class PeFindTest: public testing::PELibUnitTest {
-  // Insert your customizations here.
+ public:
+  void SetUp() override {
+    testing::PELibUnitTest::SetUp();
+    FindCache::Get()->Clear();
+  }
+
+  void TearDown() override {
+    FindCache::Get()->Clear();
+    testing::PELibUnitTest::TearDown();
+  }
 };
 
 }  // namespace
@@ -126,4 +139,130 @@ TEST_F(PeFindTest, PeFindTestDllPdbWithHint) {
   EXPECT_SAME_FILE(pdb_path, found_path);
 }
 
+TEST_F(PeFindTest, FindModulesBySignature) {
+  const base::FilePath module_path(testing::GetOutputRelativePath(
+      testing::kTestDllName));
+
+  PEFile pe_file;
+  ASSERT_TRUE(pe_file.Init(module_path));
+
+  std::vector<PEFile::Signature> module_signatures(2);
+  pe_file.GetSignature(&module_signatures[0]);
+
+  // This signature matches no module.
+  module_signatures[1] = module_signatures[0];
+  module_signatures[1].module_time_date_stamp ^= 0xFFFFFFFF;
+  module_signatures.push_back(module_signatures[0]);
+
+  std::vector<base::FilePath> found_paths;
+  EXPECT_TRUE(FindModulesBySignature(module_signatures, 2, &found_paths));
+  ASSERT_EQ(3u, found_paths.size());
+  EXPECT_SAME_FILE(module_path, found_paths[0]);
+  EXPECT_TRUE(found_paths[1].empty());
+  EXPECT_SAME_FILE(module_path, found_paths[2]);
+}
+
+TEST_F(PeFindTest, FindPdbsForModules) {
+  std::vector<base::FilePath> module_paths;
+  module_paths.push_back(testing::GetOutputRelativePath(
+      testing::kTestDllName));
+  module_paths.push_back(module_paths.back());
+
+  std::vector<base::FilePath> found_paths;
+  EXPECT_TRUE(FindPdbsForModules(module_paths, 2, &found_paths));
+  ASSERT_EQ(2u, found_paths.size());
+  const base::FilePath pdb_path(testing::GetOutputRelativePath(
+      testing::kTestDllPdbName));
+  EXPECT_SAME_FILE(pdb_path, found_paths[0]);
+  EXPECT_SAME_FILE(pdb_path, found_paths[1]);
+}
+
+TEST_F(PeFindTest, SearchesAreCached) {
+  const base::FilePath module_path(testing::GetOutputRelativePath(
+      testing::kTestDllName));
+
+  base::FilePath found_path;
+  EXPECT_TRUE(FindPdbForModule(module_path, &found_path));
+  EXPECT_FALSE(found_path.empty());
+  EXPECT_EQ(1u, FindCache::Get()->size());
+
+  // The second search is answered by the cache.
+  base::FilePath cached_path;
+  EXPECT_TRUE(FindPdbForModule(module_path, &cached_path));
+  EXPECT_EQ(found_path, cached_path);
+  EXPECT_EQ(1u, FindCache::Get()->size());
+}
+
+TEST_F(PeFindTest, StaleCacheEntriesAreIgnored) {
+  const base::FilePath module_path(testing::GetOutputRelativePath(
+      testing::kTestDllName));
+  const base::FilePath pdb_path(testing::GetOutputRelativePath(
+      testing::kTestDllPdbName));
+
+  base::FilePath found_path;
+  EXPECT_TRUE(FindPdbForModule(module_path, &found_path));
+  EXPECT_SAME_FILE(pdb_path, found_path);
+
+  // Save the cache, and point its entry at a PDB that doesn't match.
+  base::FilePath temp_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
+  base::FilePath cache_path(temp_dir.Append(L"find_cache.json"));
+  ASSERT_TRUE(FindCache::Get()->Save(cache_path));
+
+  std::string json;
+  ASSERT_TRUE(base::ReadFileToString(cache_path, &json));
+  std::unique_ptr<base::Value> value(base::JSONReader::Read(json).release());
+  base::DictionaryValue* dict = NULL;
+  ASSERT_TRUE(value.get() != NULL && value->GetAsDictionary(&dict));
+  ASSERT_EQ(1u, dict->size());
+  base::DictionaryValue::Iterator it(*dict);
+  std::string key = it.key();
+  base::FilePath stale_path(testing::GetOutputRelativePath(
+      L"pe_unittests.exe.pdb"));
+  dict->SetStringWithoutPathExpansion(key, stale_path.value());
+  ASSERT_TRUE(base::JSONWriter::Write(*dict, &json));
+  ASSERT_EQ(static_cast<int>(json.size()),
+            base::WriteFile(cache_path, json.data(),
+                            static_cast<int>(json.size())));
+
+  FindCache::Get()->Clear();
+  ASSERT_TRUE(FindCache::Get()->Load(cache_path));
+  EXPECT_EQ(1u, FindCache::Get()->size());
+
+  // The stale entry is ignored, and replaced by the result of the search.
+  found_path.clear();
+  EXPECT_TRUE(FindPdbForModule(module_path, &found_path));
+  EXPECT_SAME_FILE(pdb_path, found_path);
+  EXPECT_EQ(1u, FindCache::Get()->size());
+}
+
+TEST_F(PeFindTest, FindCacheSaveAndLoad) {
+  FindCache cache;
+  cache.Insert(L"key1", base::FilePath(L"C:\\foo\\foo.dll"));
+  cache.Insert(L"key2", base::FilePath(L"C:\\bar\\bar.pdb"));
+
+  base::FilePath temp_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
+  base::FilePath cache_path(temp_dir.Append(L"find_cache.json"));
+  ASSERT_TRUE(cache.Save(cache_path));
+
+  // Loading a missing file is fine.
+  FindCache loaded_cache;
+  EXPECT_TRUE(loaded_cache.Load(temp_dir.Append(L"missing.json")));
+  EXPECT_EQ(0u, loaded_cache.size());
+
+  EXPECT_TRUE(loaded_cache.Load(cache_path));
+  EXPECT_EQ(2u, loaded_cache.size());
+  base::FilePath path;
+  EXPECT_TRUE(loaded_cache.Lookup(L"key1", &path));
+  EXPECT_EQ(base::FilePath(L"C:\\foo\\foo.dll"), path);
+  EXPECT_TRUE(loaded_cache.Lookup(L"key2", &path));
+  EXPECT_EQ(base::FilePath(L"C:\\bar\\bar.pdb"), path);
+  EXPECT_FALSE(loaded_cache.Lookup(L"key3", &path));
+
+  loaded_cache.Erase(L"key1");
+  EXPECT_FALSE(loaded_cache.Lookup(L"key1", &path));
+  EXPECT_EQ(1u, loaded_cache.size());
+}
+
 }  // namespace pe
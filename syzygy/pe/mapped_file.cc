@@ -0,0 +1,103 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/mapped_file.h"
+
+#include "base/logging.h"
+#include "syzygy/common/com_utils.h"
+
+namespace pe {
+
+MappedFile::MappedFile() : data_(NULL), size_(0) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Init(const base::FilePath& path) {
+  Close();
+
+  // Writers are shut out, as they would otherwise be able to change the
+  // pages of the mapping that haven't been copied yet.
+  file_.Set(::CreateFile(path.value().c_str(),
+                         GENERIC_READ,
+                         FILE_SHARE_READ,
+                         NULL,
+                         OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL,
+                         NULL));
+  if (!file_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to open \"" << path.value() << "\": "
+               << common::LogWe(error) << ".";
+    return false;
+  }
+
+  LARGE_INTEGER file_size = {};
+  if (!::GetFileSizeEx(file_.Get(), &file_size)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to get the size of \"" << path.value() << "\": "
+               << common::LogWe(error) << ".";
+    file_.Close();
+    return false;
+  }
+  if (static_cast<ULONGLONG>(file_size.QuadPart) > SIZE_MAX) {
+    LOG(ERROR) << "File too large to map: " << path.value();
+    file_.Close();
+    return false;
+  }
+
+  // Empty files can't be mapped, and there's nothing to map anyway.
+  if (file_size.QuadPart == 0)
+    return true;
+
+  // The view keeps the mapping object alive once it's closed.
+  base::win::ScopedHandle mapping(::CreateFileMapping(
+      file_.Get(), NULL, PAGE_WRITECOPY, 0, 0, NULL));
+  if (!mapping.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to create a mapping of \"" << path.value() << "\": "
+               << common::LogWe(error) << ".";
+    file_.Close();
+    return false;
+  }
+
+  data_ = reinterpret_cast<uint8_t*>(
+      ::MapViewOfFile(mapping.Get(), FILE_MAP_COPY, 0, 0, 0));
+  if (data_ == NULL) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to map \"" << path.value() << "\": "
+               << common::LogWe(error) << ".";
+    file_.Close();
+    return false;
+  }
+  size_ = static_cast<size_t>(file_size.QuadPart);
+
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != NULL) {
+    if (!::UnmapViewOfFile(data_)) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Unable to unmap file: " << common::LogWe(error) << ".";
+    }
+  }
+  data_ = NULL;
+  size_ = 0;
+  file_.Close();
+}
+
+}  // namespace pe
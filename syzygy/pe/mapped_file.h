@@ -0,0 +1,68 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a copy-on-write mapping of a whole file in memory. This lets the
+// PE and COFF readers expose the contents of large images in place rather
+// than reading them into a heap buffer: only the pages that are touched are
+// brought in, and they are backed by the file rather than the page file.
+
+#ifndef SYZYGY_PE_MAPPED_FILE_H_
+#define SYZYGY_PE_MAPPED_FILE_H_
+
+#include <windows.h>
+
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "base/win/scoped_handle.h"
+
+namespace pe {
+
+class MappedFile {
+ public:
+  MappedFile();
+
+  // Unmaps the file, invalidating all pointers into it.
+  ~MappedFile();
+
+  // Maps a file. The file is kept open for the lifetime of the mapping, and
+  // may be read but not written by others meanwhile. The mapping is
+  // copy-on-write: modifications of the mapped data are private to this
+  // process and never reach the file.
+  // @param path The path of the file to map.
+  // @returns true on success, false otherwise.
+  bool Init(const base::FilePath& path);
+
+  // @name Accessors.
+  // @{
+  // @returns the mapped contents of the file. This is NULL while the file
+  //     isn't mapped, and for empty files.
+  uint8_t* data() const { return data_; }
+  // @returns the size of the file.
+  size_t size() const { return size_; }
+  // @}
+
+ private:
+  // Unmaps the current file, if any.
+  void Close();
+
+  base::win::ScopedHandle file_;
+  uint8_t* data_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+}  // namespace pe
+
+#endif  // SYZYGY_PE_MAPPED_FILE_H_
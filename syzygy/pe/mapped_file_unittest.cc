@@ -0,0 +1,88 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/pe/mapped_file.h"
+
+#include <string>
+
+#include "base/files/file_util.h"
+#include "gtest/gtest.h"
+#include "syzygy/common/unittest_util.h"
+
+namespace pe {
+
+namespace {
+
+class MappedFileTest : public testing::ApplicationTestBase {
+ public:
+  void SetUp() override {
+    testing::ApplicationTestBase::SetUp();
+    ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir_));
+  }
+
+  // Writes a file holding @p contents to the temporary directory.
+  base::FilePath WriteTestFile(const std::string& contents) {
+    base::FilePath path(temp_dir_.Append(L"file.bin"));
+    EXPECT_EQ(static_cast<int>(contents.size()),
+              base::WriteFile(path, contents.data(),
+                              static_cast<int>(contents.size())));
+    return path;
+  }
+
+  base::FilePath temp_dir_;
+};
+
+}  // namespace
+
+TEST_F(MappedFileTest, MissingFile) {
+  MappedFile mapped_file;
+  EXPECT_FALSE(mapped_file.Init(temp_dir_.Append(L"missing.bin")));
+  EXPECT_TRUE(mapped_file.data() == NULL);
+  EXPECT_EQ(0u, mapped_file.size());
+}
+
+TEST_F(MappedFileTest, EmptyFile) {
+  base::FilePath path(WriteTestFile(std::string()));
+  MappedFile mapped_file;
+  EXPECT_TRUE(mapped_file.Init(path));
+  EXPECT_TRUE(mapped_file.data() == NULL);
+  EXPECT_EQ(0u, mapped_file.size());
+}
+
+TEST_F(MappedFileTest, MapIsCopyOnWrite) {
+  const std::string kContents("some file contents");
+  base::FilePath path(WriteTestFile(kContents));
+
+  {
+    MappedFile mapped_file;
+    ASSERT_TRUE(mapped_file.Init(path));
+    ASSERT_TRUE(mapped_file.data() != NULL);
+    ASSERT_EQ(kContents.size(), mapped_file.size());
+    EXPECT_EQ(kContents,
+              std::string(reinterpret_cast<const char*>(mapped_file.data()),
+                          mapped_file.size()));
+
+    // The file can't be written while it's mapped.
+    EXPECT_EQ(-1, base::WriteFile(path, "x", 1));
+
+    // Modifying the mapping doesn't modify the file.
+    mapped_file.data()[0] = 'S';
+  }
+
+  std::string contents;
+  ASSERT_TRUE(base::ReadFileToString(path, &contents));
+  EXPECT_EQ(kContents, contents);
+}
+
+}  // namespace pe
@@ -104,6 +104,8 @@
         'dia_util_internal.h',
         'decomposer.cc',
         'decomposer.h',
+        'decomposition_cache.cc',
+        'decomposition_cache.h',
         'find.cc',
         'find.h',
         'image_filter.cc',
@@ -112,6 +114,8 @@
         'image_layout.h',
         'image_source_map.cc',
         'image_source_map.h',
+        'mapped_file.cc',
+        'mapped_file.h',
         'hot_patching_decomposer.cc',
         'hot_patching_decomposer.h',
         'hot_patching_writer.cc',
@@ -240,6 +244,7 @@
         'decompose_app_unittest.cc',
         'decompose_image_to_text_unittest.cc',
         'decomposer_unittest.cc',
+        'decomposition_cache_unittest.cc',
         'dia_browser_unittest.cc',
         'dia_util_unittest.cc',
         'find_unittest.cc',
@@ -248,6 +253,7 @@
         'image_source_map_unittest.cc',
         'hot_patching_decomposer_unittest.cc',
         'hot_patching_writer_unittest.cc',
+        'mapped_file_unittest.cc',
         'metadata_unittest.cc',
         'pdb_info_unittest.cc',
         'pe_coff_file_unittest.cc',
@@ -29,6 +29,7 @@
 #include "syzygy/core/address.h"
 #include "syzygy/core/address_space.h"
 #include "syzygy/core/serialization.h"
+#include "syzygy/pe/mapped_file.h"
 
 namespace pe {
 
@@ -105,6 +106,19 @@ class PECoffFile {
   // @returns the path of the input file read, if any.
   const base::FilePath& path() const { return path_; }
 
+  // Sets whether Init() maps the file in memory rather than reading it into
+  // a heap buffer. A mapped file may not be written for as long as this
+  // object exists, so this is off by default; only turn it on when the file
+  // won't be overwritten meanwhile. Either way, the data returned by
+  // GetImageData() may be modified without affecting the file.
+  // @param use_file_mapping true to map the file.
+  void set_use_file_mapping(bool use_file_mapping) {
+    use_file_mapping_ = use_file_mapping;
+  }
+
+  // @returns true if Init() maps the file in memory.
+  bool use_file_mapping() const { return use_file_mapping_; }
+
   // Copy mapped data to buffer. The specified range to read must be
   // contained within the image, and cannot cross data ranges from the
   // original file; in particular, sections with no gaps between them
@@ -242,7 +256,8 @@ class PECoffFile {
   // Protected constructor, for derived classes only.
   PECoffFile()
       : file_header_(NULL),
-        section_headers_(NULL) {
+        section_headers_(NULL),
+        use_file_mapping_(false) {
   }
 
   ~PECoffFile() {
@@ -269,7 +284,7 @@ class PECoffFile {
   // @returns true on success, false on error.
   bool ReadSections();
 
-  // Insert a section into the address map, backed by data in image_data_.
+  // Insert a section into the address map, backed by the image data.
   //
   // @param id the id of the section.
   // @param start the file offset to start reading at.
@@ -293,16 +308,24 @@ class PECoffFile {
   const IMAGE_FILE_HEADER* file_header_;
   const IMAGE_SECTION_HEADER* section_headers_;
 
-  // Contains all of the data in the image, as a single contiguous buffer.
+  // Whether the file is mapped rather than read.
+  bool use_file_mapping_;
+
+  // Contains all of the data in the image, as a single contiguous buffer,
+  // when the file is read.
   std::string image_data_;
 
+  // The mapping of the file, when it is mapped. This is used in place of
+  // |image_data_|.
+  MappedFile mapped_file_;
+
   // A parser for the image data. This takes care of bounds and alignment
   // checking.
   common::BinaryBufferParser parser_;
 
   // Contains all addressable data in the image. The address space has a range
   // defined for the header and each section in the image, backed by data in
-  // |image_data_|.
+  // |image_data_| or |mapped_file_|.
   ImageAddressSpace address_space_;
 
  private:
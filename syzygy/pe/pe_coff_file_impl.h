@@ -27,8 +27,16 @@ namespace pe {
 template <typename AddressSpaceTraits>
 bool PECoffFile<AddressSpaceTraits>::Init(const base::FilePath& path) {
   path_ = path;
+  base::FilePath absolute_path(base::MakeAbsoluteFilePath(path));
+  if (use_file_mapping_) {
+    if (!mapped_file_.Init(absolute_path))
+      return false;
+    parser_.SetData(mapped_file_.data(), mapped_file_.size());
+    return true;
+  }
+
   // ReadFileToString doesn't like relative paths.
-  if (!base::ReadFileToString(base::MakeAbsoluteFilePath(path), &image_data_))
+  if (!base::ReadFileToString(absolute_path, &image_data_))
     return false;
   parser_.SetData(image_data_.c_str(), image_data_.size());
   return true;
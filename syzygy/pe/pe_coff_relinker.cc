@@ -14,6 +14,8 @@
 
 #include "syzygy/pe/pe_coff_relinker.h"
 
+#include "syzygy/block_graph/block_util.h"
+#include "syzygy/block_graph/decoded_instruction_cache.h"
 #include "syzygy/block_graph/orderers/original_orderer.h"
 
 namespace pe {
@@ -28,6 +30,8 @@ using block_graph::OrderedBlockGraph;
 using block_graph::TransformPolicyInterface;
 using core::RelativeAddress;
 
+typedef core::PhaseProfiler::ScopedPhase ScopedPhase;
+
 }  // namespace
 
 PECoffRelinker::PECoffRelinker(const TransformPolicyInterface* transform_policy)
@@ -78,10 +82,19 @@ bool PECoffRelinker::AppendOrderers(const std::vector<Orderer*>& orderers) {
 
 bool PECoffRelinker::ApplyUserTransforms() {
   LOG(INFO) << "Transforming block graph.";
+  ScopedPhase phase(core::PhaseProfiler::current(), "transforms");
+
+  // The transforms each decompose the code blocks anew. Let them share the
+  // instructions decoded from the blocks that are left unchanged.
+  block_graph::DecodedInstructionCache instruction_cache;
+  block_graph::DecodedInstructionCache::ScopedCurrent scoped_cache(
+      &instruction_cache);
+
   if (!block_graph::ApplyBlockGraphTransforms(
            transforms_, transform_policy_, &block_graph_, headers_block_)) {
     return false;
   }
+  block_graph::SetPhaseCounts(block_graph_, &phase);
   return true;
 }
 
@@ -89,6 +102,7 @@ bool PECoffRelinker::ApplyUserLayoutTransforms(
     pe::ImageLayout* image_layout,
     OrderedBlockGraph* ordered_graph) {
   LOG(INFO) << "Transforming layout.";
+  ScopedPhase phase(core::PhaseProfiler::current(), "layout_transforms");
   if (!block_graph::ApplyImageLayoutTransforms(
       layout_transforms_, transform_policy_, image_layout, ordered_graph)) {
     return false;
@@ -98,6 +112,7 @@ bool PECoffRelinker::ApplyUserLayoutTransforms(
 
 bool PECoffRelinker::ApplyUserOrderers(OrderedBlockGraph* ordered_graph) {
   LOG(INFO) << "Ordering block graph.";
+  ScopedPhase phase(core::PhaseProfiler::current(), "orderers");
 
   if (orderers_.empty()) {
     // Default orderer.
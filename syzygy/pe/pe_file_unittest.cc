@@ -14,6 +14,8 @@
 
 #include "syzygy/pe/pe_file.h"
 
+#include <algorithm>
+
 #include "base/native_library.h"
 #include "base/path_service.h"
 #include "base/files/file_path.h"
@@ -126,6 +128,44 @@ TEST_F(PEFileTest, Init) {
   EXPECT_TRUE(image_file_.section_headers() != NULL);
 }
 
+TEST_F(PEFileTest, InitMapped) {
+  PEFile mapped_file;
+  EXPECT_FALSE(mapped_file.use_file_mapping());
+  mapped_file.set_use_file_mapping(true);
+  EXPECT_TRUE(mapped_file.use_file_mapping());
+  ASSERT_TRUE(mapped_file.Init(image_file_.path()));
+
+  // The mapped file exposes the same data as the file read into memory.
+  const IMAGE_NT_HEADERS* nt_headers = mapped_file.nt_headers();
+  ASSERT_TRUE(nt_headers != NULL);
+  EXPECT_EQ(0, ::memcmp(image_file_.nt_headers(), nt_headers,
+                        sizeof(*nt_headers)));
+  ASSERT_EQ(image_file_.nt_headers()->FileHeader.NumberOfSections,
+            nt_headers->FileHeader.NumberOfSections);
+  for (size_t i = 0; i < nt_headers->FileHeader.NumberOfSections; ++i) {
+    const IMAGE_SECTION_HEADER* header = mapped_file.section_header(i);
+    ASSERT_TRUE(header != NULL);
+    size_t size = std::min(header->SizeOfRawData, header->Misc.VirtualSize);
+    if (size == 0)
+      continue;
+    RelativeAddress addr(header->VirtualAddress);
+    const uint8_t* data = image_file_.GetImageData(addr, size);
+    const uint8_t* mapped_data = mapped_file.GetImageData(addr, size);
+    ASSERT_TRUE(data != NULL);
+    ASSERT_TRUE(mapped_data != NULL);
+    EXPECT_EQ(0, ::memcmp(data, mapped_data, size));
+  }
+
+  // Writes to the mapped data are private.
+  uint8_t* data = mapped_file.GetImageData(RelativeAddress(0), 1);
+  ASSERT_TRUE(data != NULL);
+  *data ^= 0xFF;
+  PEFile other_file;
+  ASSERT_TRUE(other_file.Init(image_file_.path()));
+  EXPECT_EQ(*image_file_.GetImageData(RelativeAddress(0), 1),
+            *other_file.GetImageData(RelativeAddress(0), 1));
+}
+
 TEST_F(PEFileTest, GetImageData) {
   const IMAGE_NT_HEADERS* nt_headers = image_file_.nt_headers();
   ASSERT_TRUE(nt_headers != NULL);
@@ -18,8 +18,12 @@
 #include <winnt.h>
 #include <imagehlp.h>  // NOLINT
 
+#include <algorithm>
+
+#include "base/atomicops.h"
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/threading/simple_thread.h"
 #include "base/win/scoped_handle.h"
 #include "syzygy/common/buffer_parser.h"
 #include "syzygy/common/com_utils.h"
@@ -36,9 +40,20 @@ using pe::ImageLayout;
 
 namespace {
 
+// The amount of data the image stream accumulates before writing it out.
+const size_t kWriteChunkSize = 1024 * 1024;
+
+// The number of blocks a worker thread finalizes at a time. Most blocks are
+// small, so handing them out one by one would have the threads spend their
+// time contending for the next one.
+const size_t kBlocksPerWorkItem = 64;
+
 template <class Type>
-bool UpdateReference(size_t start, Type new_value, std::vector<uint8_t>* data) {
-  BinaryBufferParser parser(&data->at(0), data->size());
+bool UpdateReference(size_t start,
+                     Type new_value,
+                     uint8_t* data,
+                     size_t data_size) {
+  BinaryBufferParser parser(data, data_size);
 
   Type* ref_ptr = NULL;
   if (!parser.GetAtIgnoreAlignment(start,
@@ -109,34 +124,327 @@ size_t GetSectionOffset(const ImageLayout& image_layout,
 
 }  // namespace
 
-PEFileWriter::PEFileWriter(const ImageLayout& image_layout)
-    : image_layout_(image_layout), nt_headers_(NULL) {
+// Accumulates the image being written and streams it to disk in chunks of
+// kWriteChunkSize, double-buffered with overlapped writes so that laying out
+// the next chunk overlaps with writing the previous one. The PE checksum of
+// the image is computed from the chunks on their way out and written over the
+// checksum field once the image is complete; the field itself is taken to be
+// zero, as CheckSumMappedFile does.
+class PEFileWriter::ImageStream {
+ public:
+  // @param checksum_offset the file offset of the checksum field.
+  explicit ImageStream(size_t checksum_offset);
+
+  // Waits for any write in flight.
+  ~ImageStream();
+
+  // Creates the image file, overwriting any existing one.
+  // @param path the path of the image.
+  // @returns true on success, false otherwise.
+  bool Open(const base::FilePath& path);
+
+  // @returns the size of the image written so far, buffered data included.
+  size_t size() const { return flushed_size_ + buffer_.size(); }
+
+  // Pads the image up to a given size.
+  // @param end the size to pad to. This must be no less than size().
+  // @param byte the padding byte.
+  void Fill(size_t end, uint8_t byte) {
+    DCHECK_LE(size(), end);
+    buffer_.resize(end - flushed_size_, byte);
+  }
+
+  // Gets a range of the image that has yet to be written out.
+  // @param offset the file offset of the range.
+  // @param data_size the size of the range.
+  // @returns a pointer to the buffered range, or NULL if any of it has been
+  //     written out already, or hasn't been appended yet.
+  uint8_t* GetData(size_t offset, size_t data_size) {
+    if (offset < flushed_size_ || offset + data_size > size())
+      return NULL;
+    return buffer_.data() + (offset - flushed_size_);
+  }
+
+  // @returns true once there's enough buffered data to be written out.
+  bool full() const { return buffer_.size() >= kWriteChunkSize; }
+
+  // Writes out the buffered data. This invalidates the pointers returned by
+  // GetData.
+  // @returns true on success, false otherwise.
+  bool Flush();
+
+  // Writes out the remaining data, then the checksum.
+  // @returns true on success, false otherwise.
+  bool Finish();
+
+ private:
+  // Starts writing @p data_size bytes of write_buffer_ at file offset
+  // @p offset.
+  bool StartWrite(size_t offset, size_t data_size);
+
+  // Waits for the write in flight, if any, to complete.
+  bool WaitForWrite();
+
+  // Adds @p data to the checksum. This needn't be called with an even number
+  // of bytes.
+  void UpdateChecksum(const uint8_t* data, size_t data_size);
+
+  base::win::ScopedHandle file_;
+  base::win::ScopedHandle event_;
+  OVERLAPPED overlapped_;
+  bool write_pending_;
+  size_t pending_size_;
+
+  // The data appended since the last flush, and the data being written.
+  std::vector<uint8_t> buffer_;
+  std::vector<uint8_t> write_buffer_;
+
+  // The size of the data flushed so far.
+  size_t flushed_size_;
+
+  // The file offset of the checksum field.
+  size_t checksum_offset_;
+
+  // The one's complement sum of the 16-bit words flushed so far, and the odd
+  // byte left over from the last flush, if any.
+  uint32_t checksum_sum_;
+  bool has_odd_byte_;
+  uint8_t odd_byte_;
+
+  DISALLOW_COPY_AND_ASSIGN(ImageStream);
+};
+
+PEFileWriter::ImageStream::ImageStream(size_t checksum_offset)
+    : write_pending_(false),
+      pending_size_(0),
+      flushed_size_(0),
+      checksum_offset_(checksum_offset),
+      checksum_sum_(0),
+      has_odd_byte_(false),
+      odd_byte_(0) {
+  ::memset(&overlapped_, 0, sizeof(overlapped_));
+  buffer_.reserve(kWriteChunkSize);
+  write_buffer_.reserve(kWriteChunkSize);
 }
 
-bool PEFileWriter::WriteImage(const base::FilePath& path) {
-  // Start by attempting to open the destination file.
-  base::ScopedFILE file(base::OpenFile(path, "wb"));
-  if (file.get() == NULL) {
-    LOG(ERROR) << "Unable to open " << path.value();
+PEFileWriter::ImageStream::~ImageStream() {
+  // The buffer in flight can't be released before the write completes.
+  WaitForWrite();
+}
+
+bool PEFileWriter::ImageStream::Open(const base::FilePath& path) {
+  DCHECK(!file_.IsValid());
+
+  file_.Set(::CreateFile(path.value().c_str(), GENERIC_WRITE, 0, NULL,
+                         CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED |
+                             FILE_FLAG_SEQUENTIAL_SCAN,
+                         NULL));
+  if (!file_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to open " << path.value() << ": "
+               << common::LogWe(error);
+    return false;
+  }
+
+  event_.Set(::CreateEvent(NULL, TRUE, FALSE, NULL));
+  if (!event_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to create event: " << common::LogWe(error);
+    return false;
+  }
+
+  return true;
+}
+
+bool PEFileWriter::ImageStream::Finish() {
+  if (!Flush() || !WaitForWrite())
+    return false;
+
+  if (has_odd_byte_) {
+    // The image is padded with a zero byte to a whole number of words.
+    const uint8_t kZero = 0;
+    UpdateChecksum(&kZero, 1);
+  }
+  uint32_t checksum = checksum_sum_ + static_cast<uint32_t>(flushed_size_);
+
+  if (checksum_offset_ + sizeof(checksum) > flushed_size_) {
+    LOG(ERROR) << "Image too small to hold its checksum.";
     return false;
   }
+  const uint8_t* checksum_data = reinterpret_cast<const uint8_t*>(&checksum);
+  write_buffer_.assign(checksum_data, checksum_data + sizeof(checksum));
+  return StartWrite(checksum_offset_, sizeof(checksum)) && WaitForWrite();
+}
+
+bool PEFileWriter::ImageStream::Flush() {
+  if (buffer_.empty())
+    return true;
+
+  // The other buffer has to be written out before it can be reused.
+  if (!WaitForWrite())
+    return false;
+
+  // The checksum field doesn't count towards the checksum. It's overwritten
+  // once the image is complete.
+  size_t end = size();
+  for (size_t i = 0; i < sizeof(DWORD); ++i) {
+    size_t offset = checksum_offset_ + i;
+    if (offset >= flushed_size_ && offset < end)
+      buffer_[offset - flushed_size_] = 0;
+  }
+  UpdateChecksum(buffer_.data(), buffer_.size());
+
+  write_buffer_.swap(buffer_);
+  buffer_.clear();
+  size_t offset = flushed_size_;
+  flushed_size_ = end;
+  return StartWrite(offset, write_buffer_.size());
+}
+
+bool PEFileWriter::ImageStream::StartWrite(size_t offset, size_t data_size) {
+  DCHECK(!write_pending_);
+  DCHECK_LE(data_size, write_buffer_.size());
+
+  ::memset(&overlapped_, 0, sizeof(overlapped_));
+  overlapped_.Offset = static_cast<DWORD>(offset);
+  overlapped_.hEvent = event_.Get();
+  if (!::WriteFile(file_.Get(), write_buffer_.data(),
+                   static_cast<DWORD>(data_size), NULL, &overlapped_)) {
+    DWORD error = ::GetLastError();
+    if (error != ERROR_IO_PENDING) {
+      LOG(ERROR) << "Failed to write image to file: " << common::LogWe(error);
+      return false;
+    }
+  }
+
+  write_pending_ = true;
+  pending_size_ = data_size;
+  return true;
+}
 
+bool PEFileWriter::ImageStream::WaitForWrite() {
+  if (!write_pending_)
+    return true;
+  write_pending_ = false;
+
+  DWORD bytes_written = 0;
+  if (!::GetOverlappedResult(file_.Get(), &overlapped_, &bytes_written,
+                             TRUE)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to write image to file: " << common::LogWe(error);
+    return false;
+  }
+  if (bytes_written != pending_size_) {
+    LOG(ERROR) << "Short write of image to file.";
+    return false;
+  }
+
+  return true;
+}
+
+void PEFileWriter::ImageStream::UpdateChecksum(const uint8_t* data,
+                                               size_t data_size) {
+  // The words are summed without folding the carries, which is equivalent as
+  // long as the sum doesn't overflow; a chunk can't get anywhere near that.
+  uint64_t sum = checksum_sum_;
+  size_t i = 0;
+  if (has_odd_byte_ && data_size != 0) {
+    sum += odd_byte_ | (data[0] << 8);
+    has_odd_byte_ = false;
+    i = 1;
+  }
+  for (; i + 1 < data_size; i += 2)
+    sum += data[i] | (data[i + 1] << 8);
+  if (i < data_size) {
+    odd_byte_ = data[i];
+    has_odd_byte_ = true;
+  }
+
+  while ((sum >> 16) != 0)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  checksum_sum_ = static_cast<uint32_t>(sum);
+}
+
+// The work shared by the worker threads finalizing the pending blocks. Each
+// run finalizes the next slice of blocks that no thread has claimed yet.
+class PEFileWriter::FinalizeWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  FinalizeWork(const PEFileWriter* writer,
+               AbsoluteAddress image_base,
+               ImageStream* stream)
+      : writer_(writer),
+        image_base_(image_base),
+        stream_(stream),
+        next_index_(0),
+        failed_(0) {
+    DCHECK(writer != NULL);
+    DCHECK(stream != NULL);
+  }
+
+  // @returns the number of work items needed to finalize all of the blocks.
+  size_t work_items() const {
+    return (writer_->pending_blocks_.size() + kBlocksPerWorkItem - 1) /
+        kBlocksPerWorkItem;
+  }
+
+  // @returns true if any of the blocks failed to be finalized.
+  bool failed() const { return base::subtle::Acquire_Load(&failed_) != 0; }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    size_t index = static_cast<size_t>(
+        base::subtle::NoBarrier_AtomicIncrement(&next_index_, 1) - 1);
+    DCHECK_LT(index, work_items());
+    size_t begin = index * kBlocksPerWorkItem;
+    size_t end = std::min(begin + kBlocksPerWorkItem,
+                          writer_->pending_blocks_.size());
+    for (size_t i = begin; i < end && !failed(); ++i) {
+      if (!writer_->FinalizeBlock(image_base_, writer_->pending_blocks_[i],
+                                  stream_)) {
+        base::subtle::Release_Store(&failed_, 1);
+      }
+    }
+  }
+  // @}
+
+ private:
+  const PEFileWriter* writer_;
+  AbsoluteAddress image_base_;
+  ImageStream* stream_;
+  base::subtle::Atomic32 next_index_;
+  base::subtle::Atomic32 failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(FinalizeWork);
+};
+
+PEFileWriter::PEFileWriter(const ImageLayout& image_layout)
+    : image_layout_(image_layout),
+      num_threads_(1),
+      nt_headers_(NULL),
+      checksum_offset_(0) {
+}
+
+bool PEFileWriter::WriteImage(const base::FilePath& path) {
   if (!ValidateHeaders())
     return false;
 
   DCHECK(nt_headers_ != NULL);
 
-  bool success = CalculateSectionRanges();
+  // Start by attempting to open the destination file.
+  ImageStream stream(checksum_offset_);
+  bool success = stream.Open(path);
+  if (success)
+    success = CalculateSectionRanges();
   if (success)
-    success = WriteBlocks(file.get());
+    success = WriteBlocks(&stream);
+  if (success)
+    success = stream.Finish();
 
   nt_headers_ = NULL;
-
-  // Close the file.
-  file.reset();
-
-  if (success)
-    success = UpdateFileChecksum(path);
+  checksum_offset_ = 0;
+  pending_blocks_.clear();
 
   return success;
 }
@@ -221,7 +529,12 @@ bool PEFileWriter::ValidateHeaders() {
       reinterpret_cast<const IMAGE_NT_HEADERS*>(nt_headers_block->data());
   DCHECK(nt_headers != NULL);
 
+  // The headers are laid out at the same offsets in memory and on disk.
+  const IMAGE_DOS_HEADER* dos_header =
+      reinterpret_cast<const IMAGE_DOS_HEADER*>(dos_header_block->data());
   nt_headers_ = nt_headers;
+  checksum_offset_ = dos_header->e_lfanew +
+      offsetof(IMAGE_NT_HEADERS, OptionalHeader.CheckSum);
 
   return true;
 }
@@ -325,17 +638,14 @@ bool PEFileWriter::CalculateSectionRanges() {
   return true;
 }
 
-bool PEFileWriter::WriteBlocks(FILE* file) {
-  DCHECK(file != NULL);
+bool PEFileWriter::WriteBlocks(ImageStream* stream) {
+  DCHECK(stream != NULL);
 
   AbsoluteAddress image_base(nt_headers_->OptionalHeader.ImageBase);
 
-  // Create the output buffer, reserving enough room for the whole file.
   DCHECK(!image_layout_.sections.empty());
   size_t last_section_index = image_layout_.sections.size() - 1;
   size_t image_size = section_file_range_map_[last_section_index].end().value();
-  std::vector<uint8_t> buffer;
-  buffer.reserve(image_size);
 
   // Iterate through all blocks in the address space writing them as we go.
   BlockGraph::AddressSpace::RangeMap::const_iterator block_it(
@@ -355,59 +665,56 @@ bool PEFileWriter::WriteBlocks(FILE* file) {
 
     // If we're jumping to a new section output the necessary padding.
     if (block->section() != section_id) {
-      FlushSection(section_index, &buffer);
+      FlushSection(section_index, stream);
       section_id = block->section();
       section_index++;
       DCHECK_GT(image_layout_.sections.size(), section_index);
     }
 
-    if (!WriteOneBlock(image_base, section_index, block, &buffer)) {
+    if (!WriteOneBlock(section_index, block, stream)) {
       LOG(ERROR) << "Failed to write block \"" << block->name() << "\".";
       return false;
     }
-  }
-
-  FlushSection(last_section_index, &buffer);
-  DCHECK_EQ(image_size, buffer.size());
 
-  // Write the whole image to disk in one go.
-  if (::fwrite(&buffer[0], sizeof(buffer[0]), buffer.size(), file) !=
-          buffer.size()) {
-    LOG(ERROR) << "Failed to write image to file.";
-    return false;
+    // The stream is only ever flushed between blocks, once the blocks laid
+    // out in the buffered data have been finalized.
+    if (stream->full()) {
+      if (!FinalizePendingBlocks(image_base, stream) || !stream->Flush())
+        return false;
+    }
   }
 
-  return true;
+  FlushSection(last_section_index, stream);
+  DCHECK_EQ(image_size, stream->size());
+
+  return FinalizePendingBlocks(image_base, stream);
 }
 
-void PEFileWriter::FlushSection(size_t section_index,
-                                std::vector<uint8_t>* buffer) {
-  DCHECK(buffer != NULL);
+void PEFileWriter::FlushSection(size_t section_index, ImageStream* stream) {
+  DCHECK(stream != NULL);
 
   size_t section_file_end =
       section_file_range_map_[section_index].end().value();
 
   // We've already sanity checked this in CalculateSectionFileRanges, so this
   // should be true.
-  DCHECK_GE(section_file_end, buffer->size());
-  if (section_file_end == buffer->size())
+  DCHECK_GE(section_file_end, stream->size());
+  if (section_file_end == stream->size())
     return;
 
   uint8_t padding_byte = GetSectionPaddingByte(image_layout_, section_index);
-  buffer->resize(section_file_end, padding_byte);
+  stream->Fill(section_file_end, padding_byte);
 
   return;
 }
 
-bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
-                                 size_t section_index,
+bool PEFileWriter::WriteOneBlock(size_t section_index,
                                  const BlockGraph::Block* block,
-                                 std::vector<uint8_t>* buffer) {
-  // This function walks through the data referred by the input block, and
-  // patches it to reflect the addresses and offsets of the blocks
-  // referenced before writing the block's data to the file.
+                                 ImageStream* stream) {
+  // This function lays out the block in the stream. Its contents are filled
+  // in by FinalizeBlock, once the addresses of all of the blocks are final.
   DCHECK(block != NULL);
-  DCHECK(buffer != NULL);
+  DCHECK(stream != NULL);
 
   RelativeAddress addr;
   if (!image_layout_.blocks.GetAddressOf(block, &addr)) {
@@ -443,7 +750,7 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
   // We shouldn't have written anything to the spot where the block belongs.
   // This is only a DCHECK because the address space of the image layout and
   // the consistency of the sections guarantees this for us.
-  DCHECK_LE(buffer->size(), file_offs.value());
+  DCHECK_LE(stream->size(), file_offs.value());
 
   size_t inited_data_size = GetBlockInitializedDataSize(block);
 
@@ -467,13 +774,12 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
   }
 
   // Add any necessary padding to get us to the block offset.
-  if (buffer->size() < file_offs.value())
-    buffer->resize(file_offs.value(), padding_byte);
+  if (stream->size() < file_offs.value())
+    stream->Fill(file_offs.value(), padding_byte);
 
-  // Copy the block data into the buffer.
-  buffer->insert(buffer->end(),
-                 block->data(),
-                 block->data() + block->data_size());
+  // Reserve room for the block data in the stream. It's copied in when the
+  // block is finalized.
+  stream->Fill(file_offs.value() + block->data_size(), 0);
 
   // We now want to append zeros for the implicit portion of the block data.
   size_t trailing_zeros = block->size() - block->data_size();
@@ -492,9 +798,62 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
     }
 
     // Write the implicit trailing zeros.
-    buffer->insert(buffer->end(), trailing_zeros, 0);
+    stream->Fill(stream->size() + trailing_zeros, 0);
   }
 
+  PendingBlock pending_block = {};
+  pending_block.block = block;
+  pending_block.addr = addr;
+  pending_block.file_offset = file_offs.value();
+  pending_block.size = stream->size() - file_offs.value();
+  pending_blocks_.push_back(pending_block);
+
+  return true;
+}
+
+bool PEFileWriter::FinalizePendingBlocks(AbsoluteAddress image_base,
+                                         ImageStream* stream) {
+  DCHECK(stream != NULL);
+
+  FinalizeWork work(this, image_base, stream);
+  size_t work_items = work.work_items();
+  if (num_threads_ <= 1 || work_items <= 1) {
+    for (size_t i = 0; i < work_items && !work.failed(); ++i)
+      work.Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "PEFileWriter",
+        static_cast<int>(std::min(num_threads_, work_items)));
+    pool.Start();
+    pool.AddWork(&work, static_cast<int>(work_items));
+    pool.JoinAll();
+  }
+
+  pending_blocks_.clear();
+  return !work.failed();
+}
+
+bool PEFileWriter::FinalizeBlock(AbsoluteAddress image_base,
+                                 const PendingBlock& pending_block,
+                                 ImageStream* stream) const {
+  // This function copies the data of the block to the stream, and patches
+  // it to reflect the addresses and offsets of the blocks referenced. It's
+  // called concurrently for distinct blocks, and only reads the state of the
+  // writer.
+  DCHECK(stream != NULL);
+  const BlockGraph::Block* block = pending_block.block;
+  DCHECK(block != NULL);
+  RelativeAddress addr = pending_block.addr;
+
+  // The block data is still buffered.
+  size_t block_data_size = pending_block.size;
+  uint8_t* block_data = stream->GetData(pending_block.file_offset,
+                                        block_data_size);
+  DCHECK(block_data != NULL || block_data_size == 0);
+  DCHECK_LE(block->data_size(), block_data_size);
+  if (block->data_size() != 0)
+    ::memcpy(block_data, block->data(), block->data_size());
+
   // Patch up all the references.
   BlockGraph::Block::ReferenceMap::const_iterator ref_it(
       block->references().begin());
@@ -539,8 +898,10 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
         // Get the offset of the block in its section, as well as the range of
         // the section on disk. Validate that the referred location is
         // actually directly represented on disk (not in implicit virtual data).
-        const FileRange& file_range =
-            section_file_range_map_[dst_section_index];
+        SectionIndexFileRangeMap::const_iterator file_range_it =
+            section_file_range_map_.find(dst_section_index);
+        DCHECK(file_range_it != section_file_range_map_.end());
+        const FileRange& file_range = file_range_it->second;
         size_t section_offset = GetSectionOffset(image_layout_,
                                                  dst_addr,
                                                  dst_section_index);
@@ -561,21 +922,26 @@ bool PEFileWriter::WriteOneBlock(AbsoluteAddress image_base,
     }
 
     // Now store the new value.
-    BlockGraph::Offset ref_offset = file_offs.value() + start;
     switch (ref.size()) {
       case sizeof(uint8_t):
-        if (!UpdateReference(ref_offset, static_cast<uint8_t>(value), buffer))
+        if (!UpdateReference(start, static_cast<uint8_t>(value), block_data,
+                             block_data_size)) {
           return false;
+        }
         break;
 
       case sizeof(uint16_t):
-        if (!UpdateReference(ref_offset, static_cast<uint16_t>(value), buffer))
+        if (!UpdateReference(start, static_cast<uint16_t>(value), block_data,
+                             block_data_size)) {
           return false;
+        }
         break;
 
       case sizeof(uint32_t):
-        if (!UpdateReference(ref_offset, static_cast<uint32_t>(value), buffer))
+        if (!UpdateReference(start, static_cast<uint32_t>(value), block_data,
+                             block_data_size)) {
           return false;
+        }
         break;
 
       default:
@@ -15,6 +15,9 @@
 #ifndef SYZYGY_PE_PE_FILE_WRITER_H_
 #define SYZYGY_PE_PE_FILE_WRITER_H_
 
+#include <vector>
+
+#include "base/logging.h"
 #include "base/files/file_path.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/core/address_space.h"
@@ -36,36 +39,80 @@ class PEFileWriter {
   // @param image_layout the image layout to write.
   explicit PEFileWriter(const ImageLayout& image_layout);
 
-  // Writes the image to path.
+  // Writes the image to path. The image is streamed to disk as it's laid
+  // out, and its checksum is computed on the way, so that only a window of
+  // the image is ever held in memory and the file needn't be read back.
   bool WriteImage(const base::FilePath& path);
 
+  // @name Accessors and mutators.
+  // @{
+  // The number of threads used to copy the block data and patch the
+  // references of each window of the image. Defaults to 1, which does all
+  // of the work on the calling thread.
+  size_t num_threads() const { return num_threads_; }
+  void set_num_threads(size_t num_threads) {
+    DCHECK_LT(0u, num_threads);
+    num_threads_ = num_threads;
+  }
+  // @}
+
   // Updates the checksum for the image @p path.
   static bool UpdateFileChecksum(const base::FilePath& path);
 
  protected:
+  // Buffers the image on its way to disk. Defined in the implementation.
+  class ImageStream;
+
+  // Finalizes pending blocks on worker threads. Defined in the
+  // implementation.
+  class FinalizeWork;
+
+  // A block that has been laid out in the stream, but whose data has yet to
+  // be copied there and whose references have yet to be patched.
+  struct PendingBlock {
+    const BlockGraph::Block* block;
+    // The address of the block.
+    RelativeAddress addr;
+    // The file offset and the size of the block data in the stream. This
+    // includes explicit trailing zeros.
+    size_t file_offset;
+    size_t size;
+  };
+  typedef std::vector<PendingBlock> PendingBlocks;
+
   // Validates the DOS header and the NT headers in the image.
-  // On success, sets the nt_headers_ pointer.
+  // On success, sets the nt_headers_ pointer and checksum_offset_.
   bool ValidateHeaders();
 
   // Validates that the section info is consistent and populates
   // section_file_range_map_ and section_index_space_.
   bool CalculateSectionRanges();
 
-  // Writes the entire image to the given file. Delegates to FlushSection and
-  // WriteOneBlock.
-  bool WriteBlocks(FILE* file);
+  // Writes the entire image to the given stream. Delegates to FlushSection,
+  // WriteOneBlock and FinalizePendingBlocks.
+  bool WriteBlocks(ImageStream* stream);
 
   // Closes off the writing of a section by adding any necessary padding to the
-  // output buffer.
-  void FlushSection(size_t section_index, std::vector<uint8_t>* buffer);
-
-  // Writes a single block to the buffer, first writing any necessary padding
-  // (the content of which depends on the section type), followed by the
-  // block data (containing finalized references).
-  bool WriteOneBlock(AbsoluteAddress image_base,
-                     size_t section_index,
+  // output stream.
+  void FlushSection(size_t section_index, ImageStream* stream);
+
+  // Lays out a single block in the stream, first writing any necessary
+  // padding (the content of which depends on the section type), then
+  // reserving room for the block data. The block is added to
+  // pending_blocks_.
+  bool WriteOneBlock(size_t section_index,
                      const BlockGraph::Block* block,
-                     std::vector<uint8_t>* buffer);
+                     ImageStream* stream);
+
+  // Finalizes the blocks in pending_blocks_, on num_threads_ threads, and
+  // clears it. This has to happen before the stream is flushed.
+  bool FinalizePendingBlocks(AbsoluteAddress image_base, ImageStream* stream);
+
+  // Copies the data of a pending block to the stream and patches its
+  // references. This may be called concurrently for distinct blocks.
+  bool FinalizeBlock(AbsoluteAddress image_base,
+                     const PendingBlock& pending_block,
+                     ImageStream* stream) const;
 
   // The file ranges of each section. This is populated by
   // CalculateSectionRanges and is a map from section index (as ordered in
@@ -85,9 +132,20 @@ class PEFileWriter {
   // Our image layout as provided to the constructor.
   const ImageLayout& image_layout_;
 
+  // The number of threads finalizing blocks.
+  size_t num_threads_;
+
+  // The blocks laid out in the buffered data of the stream, in order. This is
+  // only used during WriteImage.
+  PendingBlocks pending_blocks_;
+
   // Refers to the nt headers from the image during WriteImage.
   const IMAGE_NT_HEADERS* nt_headers_;
 
+  // The file offset of the checksum in the NT headers, valid during
+  // WriteImage.
+  size_t checksum_offset_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(PEFileWriter);
 };
@@ -14,6 +14,8 @@
 
 #include "syzygy/pe/pe_file_writer.h"
 
+#include <imagehlp.h>  // NOLINT
+
 #include "base/path_service.h"
 #include "base/files/file_util.h"
 #include "gmock/gmock.h"
@@ -66,6 +68,69 @@ TEST_F(PEFileWriterTest, RewriteAndLoadImage) {
   ASSERT_NO_FATAL_FAILURE(CheckTestDll(temp_file));
 }
 
+TEST_F(PEFileWriterTest, WriteImageComputesChecksum) {
+  base::FilePath temp_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
+  base::FilePath temp_file = temp_dir.Append(testing::kTestDllName);
+
+  PEFile image_file;
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer decomposer(image_file);
+  block_graph::BlockGraph block_graph;
+  pe::ImageLayout image_layout(&block_graph);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  // Clobber the checksum in the headers, it should be recomputed.
+  BlockGraph::Block* dos_header_block =
+      image_layout.blocks.GetBlockByAddress(RelativeAddress(0));
+  BlockGraph::Block* nt_headers_block =
+      GetNtHeadersBlockFromDosHeaderBlock(dos_header_block);
+  ASSERT_TRUE(nt_headers_block != NULL);
+  IMAGE_NT_HEADERS* nt_headers =
+      reinterpret_cast<IMAGE_NT_HEADERS*>(nt_headers_block->GetMutableData());
+  nt_headers->OptionalHeader.CheckSum ^= 0xF00DF00D;
+
+  PEFileWriter writer(image_layout);
+  ASSERT_TRUE(writer.WriteImage(temp_file));
+
+  // The checksum in the image is the one the OS computes.
+  DWORD header_sum = 0;
+  DWORD check_sum = 0;
+  ASSERT_EQ(CHECKSUM_SUCCESS,
+            ::MapFileAndCheckSum(temp_file.value().c_str(), &header_sum,
+                                 &check_sum));
+  EXPECT_EQ(check_sum, header_sum);
+}
+
+TEST_F(PEFileWriterTest, ParallelWriteMatchesSerialWrite) {
+  base::FilePath temp_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
+  base::FilePath serial_file = temp_dir.Append(L"serial.dll");
+  base::FilePath parallel_file = temp_dir.Append(L"parallel.dll");
+
+  PEFile image_file;
+  base::FilePath image_path(testing::GetExeRelativePath(testing::kTestDllName));
+  ASSERT_TRUE(image_file.Init(image_path));
+
+  Decomposer decomposer(image_file);
+  block_graph::BlockGraph block_graph;
+  pe::ImageLayout image_layout(&block_graph);
+  ASSERT_TRUE(decomposer.Decompose(&image_layout));
+
+  PEFileWriter serial_writer(image_layout);
+  EXPECT_EQ(1u, serial_writer.num_threads());
+  ASSERT_TRUE(serial_writer.WriteImage(serial_file));
+
+  PEFileWriter parallel_writer(image_layout);
+  parallel_writer.set_num_threads(4);
+  EXPECT_EQ(4u, parallel_writer.num_threads());
+  ASSERT_TRUE(parallel_writer.WriteImage(parallel_file));
+
+  EXPECT_TRUE(base::ContentsEqual(serial_file, parallel_file));
+}
+
 TEST_F(PEFileWriterTest, UpdateFileChecksum) {
   base::FilePath temp_dir;
   ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
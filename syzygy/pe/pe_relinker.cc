@@ -15,6 +15,10 @@
 #include "syzygy/pe/pe_relinker.h"
 
 #include "base/files/file_util.h"
+#include "base/sys_info.h"
+#include "base/threading/simple_thread.h"
+#include "syzygy/block_graph/block_util.h"
+#include "syzygy/core/file_util.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
 #include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_reader.h"
@@ -37,6 +41,7 @@ typedef block_graph::BlockGraphOrdererInterface Orderer;
 using block_graph::ApplyBlockGraphTransform;
 using block_graph::BlockGraph;
 using block_graph::OrderedBlockGraph;
+using block_graph::SetPhaseCounts;
 using core::RelativeAddress;
 using pdb::NameStreamMap;
 using pdb::PdbByteStream;
@@ -46,9 +51,12 @@ using pdb::PdbMutatorInterface;
 using pdb::PdbStream;
 using pdb::WritablePdbStream;
 
+typedef core::PhaseProfiler::ScopedPhase ScopedPhase;
+
 // Decomposes the module enclosed by the given PE file.
 bool Decompose(const PEFile& pe_file,
                const base::FilePath& pdb_path,
+               size_t pdb_reader_threads,
                ImageLayout* image_layout,
                BlockGraph::Block** dos_header_block) {
   DCHECK(image_layout != NULL);
@@ -62,6 +70,7 @@ bool Decompose(const PEFile& pe_file,
   // Decompose the input image.
   Decomposer decomposer(pe_file);
   decomposer.set_pdb_path(pdb_path);
+  decomposer.set_pdb_reader_threads(pdb_reader_threads);
   if (!decomposer.Decompose(&orig_image_layout)) {
     LOG(ERROR) << "Unable to decompose module: " << pe_file.path().value();
     return false;
@@ -91,6 +100,9 @@ bool Decompose(const PEFile& pe_file,
 bool WriteImage(const ImageLayout& image_layout,
                 const base::FilePath& output_path) {
   PEFileWriter writer(image_layout);
+  // Patch the references on every processor. The output is the same.
+  writer.set_num_threads(
+      static_cast<size_t>(base::SysInfo::NumberOfProcessors()));
 
   LOG(INFO) << "Writing image: " << output_path.value();
   if (!writer.WriteImage(output_path)) {
@@ -103,12 +115,55 @@ bool WriteImage(const ImageLayout& image_layout,
 
 }  // namespace
 
+// Reads, mutates and, unless the PDB is augmented, finalizes and writes the
+// PDB. The phase profiler isn't thread-safe, so the phases of this work
+// aren't recorded.
+class PERelinker::PdbWork : public base::DelegateSimpleThread::Delegate {
+ public:
+  PdbWork(PERelinker* relinker,
+          const ImageLayout* output_image_layout,
+          PdbFile* pdb_file)
+      : relinker_(relinker),
+        output_image_layout_(output_image_layout),
+        pdb_file_(pdb_file),
+        succeeded_(false) {
+    DCHECK(relinker != NULL);
+    DCHECK(output_image_layout != NULL);
+    DCHECK(pdb_file != NULL);
+  }
+
+  // @returns true if the work succeeded. Only valid once the thread running
+  //     it has been joined.
+  bool succeeded() const { return succeeded_; }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override {
+    succeeded_ = relinker_->ReadAndMutatePdb(NULL, pdb_file_);
+    if (succeeded_ && !relinker_->augment_pdb_) {
+      succeeded_ = relinker_->FinalizeAndWritePdb(NULL, *output_image_layout_,
+                                                  pdb_file_);
+    }
+  }
+  // @}
+
+ private:
+  PERelinker* relinker_;
+  const ImageLayout* output_image_layout_;
+  PdbFile* pdb_file_;
+  bool succeeded_;
+
+  DISALLOW_COPY_AND_ASSIGN(PdbWork);
+};
+
 PERelinker::PERelinker(const PETransformPolicy* pe_transform_policy)
     : PECoffRelinker(pe_transform_policy),
       pe_transform_policy_(pe_transform_policy),
       add_metadata_(true), augment_pdb_(true),
-      compress_pdb_(false), strip_strings_(false),
-      padding_(0), code_alignment_(1), output_guid_(GUID_NULL) {
+      compress_pdb_(false), incremental_pdb_(false), strip_strings_(false),
+      padding_(0), code_alignment_(1), pdb_reader_threads_(0),
+      arena_storage_(false),
+      output_guid_(GUID_NULL) {
   DCHECK(pe_transform_policy != NULL);
 }
 
@@ -140,7 +195,11 @@ bool PERelinker::Init() {
   LOG(INFO) << "Output module: " << output_path_.value();
   LOG(INFO) << "Output PDB   : " << output_pdb_path_.value();
 
-  // Open the input PE file.
+  // Open the input PE file. It's mapped rather than read unless it's about to
+  // be overwritten, as a mapped file can't be written.
+  input_pe_file_.set_use_file_mapping(
+      core::CompareFilePaths(input_path_, output_path_) ==
+          core::kDistinctFilePaths);
   if (!input_pe_file_.Init(input_path_)) {
     LOG(ERROR) << "Unable to load \"" << input_path_.value() << "\".";
     return false;
@@ -152,10 +211,18 @@ bool PERelinker::Init() {
     return false;
   }
 
+  // The arena has to be in place before the first block is added.
+  if (arena_storage_)
+    block_graph_.EnableArenaStorage();
+
   // Decompose the image.
-  if (!Decompose(input_pe_file_, input_pdb_path_, &input_image_layout_,
-                 &headers_block_)) {
-    return false;
+  {
+    ScopedPhase phase(core::PhaseProfiler::current(), "decompose");
+    if (!Decompose(input_pe_file_, input_pdb_path_, pdb_reader_threads_,
+                   &input_image_layout_, &headers_block_)) {
+      return false;
+    }
+    SetPhaseCounts(block_graph_, &phase);
   }
 
   inited_ = true;
@@ -169,15 +236,21 @@ bool PERelinker::Relink() {
     return false;
   }
 
+  core::PhaseProfiler* profiler = core::PhaseProfiler::current();
+
   // Apply the user supplied transforms.
   if (!ApplyUserTransforms())
     return false;
 
   // Finalize the block-graph. This applies PE and Syzygy specific transforms.
-  if (!FinalizeBlockGraph(input_path_, output_pdb_path_, output_guid_,
-                          add_metadata_, pe_transform_policy_, &block_graph_,
-                          headers_block_)) {
-    return false;
+  {
+    ScopedPhase phase(profiler, "finalize_block_graph");
+    if (!FinalizeBlockGraph(input_path_, output_pdb_path_, output_guid_,
+                            add_metadata_, pe_transform_policy_, &block_graph_,
+                            headers_block_)) {
+      return false;
+    }
+    SetPhaseCounts(block_graph_, &phase);
   }
 
   // Apply the user supplied orderers.
@@ -186,59 +259,123 @@ bool PERelinker::Relink() {
     return false;
 
   // Finalize the ordered block graph. This applies PE specific orderers.
-  if (!FinalizeOrderedBlockGraph(&ordered_block_graph, headers_block_))
-    return false;
+  {
+    ScopedPhase phase(profiler, "finalize_ordered_block_graph");
+    if (!FinalizeOrderedBlockGraph(&ordered_block_graph, headers_block_))
+      return false;
+  }
 
   // Lay it out.
   ImageLayout output_image_layout(&block_graph_);
-  if (!BuildImageLayout(padding_, code_alignment_,
-                        ordered_block_graph, headers_block_,
-                        &output_image_layout)) {
-    return false;
+  {
+    ScopedPhase phase(profiler, "build_layout");
+    if (!BuildImageLayout(padding_, code_alignment_,
+                          ordered_block_graph, headers_block_,
+                          &output_image_layout)) {
+      return false;
+    }
   }
 
   if (!ApplyUserLayoutTransforms(&output_image_layout, &ordered_block_graph))
     return false;
 
+  // The layout and the output GUID are now fixed, so the PDB is processed
+  // while the image is being written. Both only read the layout.
+  PdbFile pdb_file;
+  PdbWork pdb_work(this, &output_image_layout, &pdb_file);
+  base::DelegateSimpleThread pdb_thread(&pdb_work, "PdbWork");
+  pdb_thread.Start();
+
   // Write the image.
-  if (!WriteImage(output_image_layout, output_path_))
+  bool image_written = false;
+  {
+    ScopedPhase phase(profiler, "write_image");
+    image_written = WriteImage(output_image_layout, output_path_);
+  }
+
+  {
+    ScopedPhase phase(profiler, "wait_for_pdb");
+    pdb_thread.Join();
+  }
+  if (!image_written || !pdb_work.succeeded())
     return false;
 
-  // From here on down we are processing the PDB file.
+  // The augmented PDB contains a serialized block-graph that is built from
+  // the written image, so it can only be finalized now.
+  if (augment_pdb_ &&
+      !FinalizeAndWritePdb(profiler, output_image_layout, &pdb_file)) {
+    return false;
+  }
+
+  LOG(INFO) << "PE relinker finished.";
+
+  return true;
+}
+
+bool PERelinker::ReadAndMutatePdb(core::PhaseProfiler* profiler,
+                                  PdbFile* pdb_file) {
+  DCHECK(pdb_file != NULL);
 
   // Read the PDB file.
   LOG(INFO) << "Reading PDB file: " << input_pdb_path_.value();
   pdb::PdbReader pdb_reader;
-  PdbFile pdb_file;
-  if (!pdb_reader.Read(input_pdb_path_, &pdb_file)) {
-    LOG(ERROR) << "Unable to read PDB file: " << input_pdb_path_.value();
-    return false;
+  {
+    ScopedPhase phase(profiler, "read_pdb");
+    if (!pdb_reader.Read(input_pdb_path_, pdb_file)) {
+      LOG(ERROR) << "Unable to read PDB file: " << input_pdb_path_.value();
+      return false;
+    }
   }
 
   // Apply any user specified mutators to the PDB file.
-  if (!pdb::ApplyPdbMutators(pdb_mutators_, &pdb_file))
-    return false;
+  {
+    ScopedPhase phase(profiler, "pdb_mutators");
+    if (!pdb::ApplyPdbMutators(pdb_mutators_, pdb_file))
+      return false;
+  }
+
+  return true;
+}
+
+bool PERelinker::FinalizeAndWritePdb(core::PhaseProfiler* profiler,
+                                     const ImageLayout& output_image_layout,
+                                     PdbFile* pdb_file) {
+  DCHECK(pdb_file != NULL);
 
   // Finalize the PDB file.
-  RelativeAddressRange input_range;
-  GetOmapRange(input_image_layout_.sections, &input_range);
-  if (!FinalizePdbFile(input_path_, output_path_, input_range,
-                       output_image_layout, output_guid_, augment_pdb_,
-                       strip_strings_, compress_pdb_, &pdb_file)) {
-    return false;
+  {
+    ScopedPhase phase(profiler, "finalize_pdb");
+    RelativeAddressRange input_range;
+    GetOmapRange(input_image_layout_.sections, &input_range);
+    if (!FinalizePdbFile(input_path_, output_path_, input_range,
+                         output_image_layout, output_guid_, augment_pdb_,
+                         strip_strings_, compress_pdb_, pdb_file)) {
+      return false;
+    }
   }
 
   // Write the PDB file.
   LOG(INFO) << "Writing the PDB.";
-  pdb::PdbWriter pdb_writer;
-  if (!pdb_writer.Write(output_pdb_path_, pdb_file)) {
-    LOG(ERROR) << "Failed to write PDB file \"" << output_pdb_path_.value()
-               << "\".";
-    return false;
+  {
+    ScopedPhase phase(profiler, "write_pdb");
+    pdb::PdbWriter pdb_writer;
+    // Write the streams on every processor. The output is the same.
+    pdb_writer.set_num_threads(
+        static_cast<size_t>(base::SysInfo::NumberOfProcessors()));
+    bool written = false;
+    if (incremental_pdb_) {
+      written = pdb_writer.WriteIncremental(input_pdb_path_, output_pdb_path_,
+                                            *pdb_file);
+    } else {
+      written = pdb_writer.Write(output_pdb_path_, *pdb_file);
+    }
+    if (!written) {
+      LOG(ERROR) << "Failed to write PDB file \"" << output_pdb_path_.value()
+                 << "\".";
+      return false;
+    }
   }
 
-  LOG(INFO) << "PE relinker finished.";
-
   return true;
 }
 
@@ -64,6 +64,8 @@
 #include "base/files/file_path.h"
 #include "syzygy/block_graph/orderer.h"
 #include "syzygy/block_graph/transform.h"
+#include "syzygy/core/phase_profiler.h"
+#include "syzygy/pdb/pdb_file.h"
 #include "syzygy/pdb/pdb_mutator.h"
 #include "syzygy/pe/image_layout.h"
 #include "syzygy/pe/pe_coff_relinker.h"
@@ -98,7 +100,10 @@ namespace pe {
 // 4. PEImageLayoutBuilder is used to convert the OrderedBlockGraph to an
 //    ImageLayout.
 // 5. Image and accompanying PDB file are written. (Filenames are inferred from
-//    input filenames or directly specified.)
+//    input filenames or directly specified.) The PDB is read, mutated and
+//    written on a worker thread while the image is being written. When the
+//    PDB is augmented, it is only finalized and written once the image has
+//    been written, as the serialized block-graph is built from it.
 class PERelinker : public PECoffRelinker {
  public:
   // Constructor.
@@ -118,9 +123,12 @@ class PERelinker : public PECoffRelinker {
   bool add_metadata() const { return add_metadata_; }
   bool augment_pdb() const { return augment_pdb_; }
   bool compress_pdb() const { return compress_pdb_; }
+  bool incremental_pdb() const { return incremental_pdb_; }
   bool strip_strings() const { return strip_strings_; }
   size_t padding() const { return padding_; }
   size_t code_alignment() const { return code_alignment_; }
+  size_t pdb_reader_threads() const { return pdb_reader_threads_; }
+  bool arena_storage() const { return arena_storage_; }
   // @}
 
   // @name Mutators for controlling relinker behaviour.
@@ -140,6 +148,9 @@ class PERelinker : public PECoffRelinker {
   void set_compress_pdb(bool compress_pdb) {
     compress_pdb_ = compress_pdb;
   }
+  void set_incremental_pdb(bool incremental_pdb) {
+    incremental_pdb_ = incremental_pdb;
+  }
   void set_strip_strings(bool strip_strings) {
     strip_strings_ = strip_strings;
   }
@@ -149,6 +160,12 @@ class PERelinker : public PECoffRelinker {
   void set_code_alignment(size_t alignment) {
     code_alignment_ = alignment;
   }
+  void set_pdb_reader_threads(size_t pdb_reader_threads) {
+    pdb_reader_threads_ = pdb_reader_threads;
+  }
+  void set_arena_storage(bool arena_storage) {
+    arena_storage_ = arena_storage;
+  }
   // @}
 
   // @see RelinkerInterface::AppendPdbMutator()
@@ -192,6 +209,25 @@ class PERelinker : public PECoffRelinker {
   // @}
 
  protected:
+  // Processes the PDB on a worker thread.
+  class PdbWork;
+
+  // Reads the input PDB and applies the user supplied mutators to it.
+  // @param profiler The profiler recording the phases, or NULL.
+  // @param pdb_file Receives the mutated PDB.
+  // @returns true on success, false otherwise.
+  bool ReadAndMutatePdb(core::PhaseProfiler* profiler,
+                        pdb::PdbFile* pdb_file);
+
+  // Finalizes the PDB for the output image, and writes it.
+  // @param profiler The profiler recording the phases, or NULL.
+  // @param output_image_layout The layout of the output image.
+  // @param pdb_file The PDB to finalize and write.
+  // @returns true on success, false otherwise.
+  bool FinalizeAndWritePdb(core::PhaseProfiler* profiler,
+                           const ImageLayout& output_image_layout,
+                           pdb::PdbFile* pdb_file);
+
   // The transform policy used by this relinker.
   const PETransformPolicy* pe_transform_policy_;
 
@@ -206,6 +242,9 @@ class PERelinker : public PECoffRelinker {
   // If true, then the augmented PDB stream will be compressed as it is written.
   // Defaults to false.
   bool compress_pdb_;
+  // If true, the output PDB is written by updating a copy of the input PDB,
+  // leaving the pages of the unmodified streams in place. Defaults to false.
+  bool incremental_pdb_;
   // If true, strings associated with a block-graph will not be serialized into
   // the PDB. Defaults to false.
   bool strip_strings_;
@@ -214,6 +253,13 @@ class PERelinker : public PECoffRelinker {
   size_t padding_;
   // Minimal code block alignment.
   size_t code_alignment_;
+  // The number of threads the decomposer parses the PDB with, using the
+  // in-house PDB readers. Zero is the default value and indicates that the
+  // decomposer uses DIA. @see Decomposer::set_pdb_reader_threads.
+  size_t pdb_reader_threads_;
+  // Indicates whether the block graph draws the nodes of its containers from
+  // an arena. Defaults to false. @see BlockGraph::EnableArenaStorage.
+  bool arena_storage_;
 
   // The vectors of user supplied transforms, orderers and mutators to be
   // applied.
@@ -162,6 +162,12 @@ TEST_F(PERelinkerTest, Properties) {
   EXPECT_EQ(10u, relinker.code_alignment());
   relinker.set_code_alignment(1);
   EXPECT_EQ(1u, relinker.code_alignment());
+
+  EXPECT_FALSE(relinker.arena_storage());
+  relinker.set_arena_storage(true);
+  EXPECT_TRUE(relinker.arena_storage());
+  relinker.set_arena_storage(false);
+  EXPECT_FALSE(relinker.arena_storage());
 }
 
 TEST_F(PERelinkerTest, AppendPdbMutators) {
@@ -360,6 +366,48 @@ TEST_F(PERelinkerTest, BlockGraphStreamIsCreated) {
   ASSERT_GT(stream->length(), 0u);
 }
 
+TEST_F(PERelinkerTest, UnaugmentedPdbIsWritten) {
+  TestPERelinker relinker(&policy_);
+  StrictMock<MockPdbMutator> pdb_mutator;
+  EXPECT_CALL(pdb_mutator, MutatePdb(_)).WillOnce(Return(true));
+
+  // The PDB is then entirely processed while the image is being written.
+  relinker.AppendPdbMutator(&pdb_mutator);
+  relinker.set_input_path(input_dll_);
+  relinker.set_output_path(temp_dll_);
+  relinker.set_augment_pdb(false);
+
+  EXPECT_TRUE(relinker.Init());
+  EXPECT_TRUE(relinker.Relink());
+  ASSERT_NO_FATAL_FAILURE(CheckTestDll(relinker.output_path()));
+
+  // The PDB matches the image, and has no block-graph stream.
+  pdb::PdbFile pdb_file;
+  pdb::PdbReader pdb_reader;
+  ASSERT_TRUE(pdb_reader.Read(temp_pdb_, &pdb_file));
+  pdb::PdbInfoHeader70 pdb_header = {0};
+  pdb::NameStreamMap name_stream_map;
+  EXPECT_TRUE(
+      ReadHeaderInfoStream(pdb_file.GetStream(pdb::kPdbHeaderInfoStream).get(),
+                           &pdb_header, &name_stream_map));
+  EXPECT_EQ(relinker.output_guid(), pdb_header.signature);
+  EXPECT_TRUE(name_stream_map.find(pdb::kSyzygyBlockGraphStreamName) ==
+              name_stream_map.end());
+}
+
+TEST_F(PERelinkerTest, FailsWhenUnaugmentedPdbMutatorFails) {
+  TestPERelinker relinker(&policy_);
+  StrictMock<MockPdbMutator> pdb_mutator;
+  EXPECT_CALL(pdb_mutator, MutatePdb(_)).WillOnce(Return(false));
+
+  relinker.AppendPdbMutator(&pdb_mutator);
+  relinker.set_input_path(input_dll_);
+  relinker.set_output_path(temp_dll_);
+  relinker.set_augment_pdb(false);
+  EXPECT_TRUE(relinker.Init());
+  EXPECT_FALSE(relinker.Relink());
+}
+
 TEST_F(PERelinkerTest, BlockGraphStreamVersionIsTheCurrentOne) {
   TestPERelinker relinker(&policy_);
 
@@ -15,6 +15,7 @@
 #include "syzygy/pe/pe_relinker_util.h"
 
 #include "base/files/file_util.h"
+#include "base/sys_info.h"
 #include "syzygy/block_graph/transform.h"
 #include "syzygy/core/file_util.h"
 #include "syzygy/core/zstream.h"
@@ -281,7 +282,9 @@ bool WriteSyzygyBlockGraphStream(const PEFile& pe_file,
   if (compress) {
     zip_stream.reset(new core::ZOutStream(&pdb_out_stream));
     out_stream = zip_stream.get();
-    if (!zip_stream->Init(core::ZOutStream::kZBestCompression)) {
+    // Compress on every processor. The output remains a plain zlib stream.
+    size_t threads = static_cast<size_t>(base::SysInfo::NumberOfProcessors());
+    if (!zip_stream->Init(core::ZOutStream::kZBestCompression, threads)) {
       LOG(ERROR) << "Failed to initialize zlib compressor.";
       return false;
     }
@@ -139,29 +139,65 @@ PETransformPolicy::PETransformPolicy()
 
 bool PETransformPolicy::BlockIsSafeToBasicBlockDecompose(
     const BlockGraph::Block* block) const {
+  return DecisionIsSafe(GetDecompositionDecision(block));
+}
+
+PETransformPolicy::DecompositionDecision
+PETransformPolicy::GetDecompositionDecision(
+    const BlockGraph::Block* block) const {
   DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), block);
 
   if (block->type() != BlockGraph::CODE_BLOCK)
-    return false;
+    return kUnsafeNotCodeBlock;
 
   // Check attributes directly here, outside of the cache. These are cheap to
-  // check and can change during decomposition/transformation, so can
-  // potentially change cached results.
+  // check, and don't depend on allow_inline_assembly_ being constant.
   if (block->attributes() & BlockGraph::BUILT_BY_SYZYGY)
-    return true;
+    return kSafeBuiltBySyzygy;
   if (!CodeBlockAttributesAreBasicBlockSafe(block, allow_inline_assembly_))
-    return false;
+    return kUnsafeAttributes;
 
-  // Look for a cached result. This prevents repeated (expensive) calculations
-  // and inspections over the block.
+  // Look for a cached decision. This prevents repeated (expensive)
+  // inspections of the block, as long as it hasn't changed since.
   BlockResultCache::const_iterator it = block_result_cache_->find(
       block->id());
-  if (it != block_result_cache_->end())
-    return it->second;
+  if (it != block_result_cache_->end() &&
+      it->second.change_count == block->change_count()) {
+    return it->second.decision;
+  }
 
-  bool result = CodeBlockIsSafeToBasicBlockDecompose(block);
-  block_result_cache_->insert(std::make_pair(block->id(), result));
-  return result;
+  CachedDecision cached = { block->change_count(),
+                            GetCodeBlockDecompositionDecision(block) };
+  (*block_result_cache_)[block->id()] = cached;
+  if (!DecisionIsSafe(cached.decision)) {
+    VLOG(1) << "Block \"" << block->name() << "\" is not safe to basic-block "
+            << "decompose: " << DecisionToString(cached.decision) << ".";
+  }
+  return cached.decision;
+}
+
+const char* PETransformPolicy::DecisionToString(
+    DecompositionDecision decision) {
+  switch (decision) {
+    case kSafeBuiltBySyzygy:
+      return "built by Syzygy";
+    case kSafe:
+      return "safe";
+    case kUnsafeNotCodeBlock:
+      return "not a code block";
+    case kUnsafeAttributes:
+      return "unsupported block attributes";
+    case kUnsafeNoPrivateSymbols:
+      return "no private symbols";
+    case kUnsafeLayout:
+      return "code-data layout inconsistent with CL.EXE";
+    case kUnsafeReferences:
+      return "references inconsistent with CL.EXE";
+    case kUnsafeReferrers:
+      return "referrers inconsistent with CL.EXE";
+  }
+  NOTREACHED();
+  return "unknown";
 }
 
 bool PETransformPolicy::ReferenceIsSafeToRedirect(
@@ -174,25 +210,31 @@ bool PETransformPolicy::ReferenceIsSafeToRedirect(
 
 bool PETransformPolicy::CodeBlockIsSafeToBasicBlockDecompose(
     const BlockGraph::Block* code_block) const {
+  return DecisionIsSafe(GetCodeBlockDecompositionDecision(code_block));
+}
+
+PETransformPolicy::DecompositionDecision
+PETransformPolicy::GetCodeBlockDecompositionDecision(
+    const BlockGraph::Block* code_block) const {
   DCHECK_NE(reinterpret_cast<BlockGraph::Block*>(NULL), code_block);
   DCHECK_EQ(BlockGraph::CODE_BLOCK, code_block->type());
 
   // If the code_block was built by our toolchain it's inherently safe.
   if (code_block->attributes() & BlockGraph::BUILT_BY_SYZYGY)
-    return true;
+    return kSafeBuiltBySyzygy;
 
   if (!CodeBlockAttributesAreBasicBlockSafe(code_block, allow_inline_assembly_))
-    return false;
+    return kUnsafeAttributes;
   if (!CodeBlockHasPrivateSymbols(code_block))
-    return false;
+    return kUnsafeNoPrivateSymbols;
   if (!CodeBlockLayoutIsClConsistent(code_block))
-    return false;
+    return kUnsafeLayout;
   if (!CodeBlockReferencesAreClConsistent(code_block))
-    return false;
+    return kUnsafeReferences;
   if (!CodeBlockReferrersAreClConsistent(code_block))
-    return false;
+    return kUnsafeReferrers;
 
-  return true;
+  return kSafe;
 }
 
 bool PETransformPolicy::CodeBlockHasPrivateSymbols(
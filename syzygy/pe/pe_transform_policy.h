@@ -27,6 +27,27 @@ namespace pe {
 // files.
 class PETransformPolicy : public block_graph::TransformPolicyInterface {
  public:
+  // The basic-block decomposition decisions, each with the reason it was
+  // made.
+  enum DecompositionDecision {
+    // The block was built by our toolchain, and is inherently safe.
+    kSafeBuiltBySyzygy,
+    // The block passed all of the checks.
+    kSafe,
+    // The block isn't a code block.
+    kUnsafeNotCodeBlock,
+    // The block has attributes that preclude decomposition.
+    kUnsafeAttributes,
+    // The block has no private symbols.
+    kUnsafeNoPrivateSymbols,
+    // The code-data layout of the block isn't consistent with CL.EXE.
+    kUnsafeLayout,
+    // The outgoing references of the block aren't consistent with CL.EXE.
+    kUnsafeReferences,
+    // The referrers of the block aren't consistent with CL.EXE.
+    kUnsafeReferrers,
+  };
+
   PETransformPolicy();
   virtual ~PETransformPolicy() { }
 
@@ -39,6 +60,24 @@ class PETransformPolicy : public block_graph::TransformPolicyInterface {
       const BlockGraph::Reference& reference) const override;
   // @}
 
+  // Decides whether a block is safe to basic-block decompose, and why. The
+  // expensive parts of the decision are cached per block, and recomputed
+  // when the block has changed since.
+  // @param block The block to inspect.
+  // @returns the decision.
+  DecompositionDecision GetDecompositionDecision(
+      const BlockGraph::Block* block) const;
+
+  // @param decision A decomposition decision.
+  // @returns true if @p decision allows decomposition.
+  static bool DecisionIsSafe(DecompositionDecision decision) {
+    return decision == kSafeBuiltBySyzygy || decision == kSafe;
+  }
+
+  // @param decision A decomposition decision.
+  // @returns a description of the reason for @p decision.
+  static const char* DecisionToString(DecompositionDecision decision);
+
   bool allow_inline_assembly() const { return allow_inline_assembly_; }
   void set_allow_inline_assembly(bool value) {
     allow_inline_assembly_ = value;
@@ -51,6 +90,9 @@ class PETransformPolicy : public block_graph::TransformPolicyInterface {
   // Internal implementation details. Exposed for unittesting.
   bool CodeBlockIsSafeToBasicBlockDecompose(
       const BlockGraph::Block* code_block) const;
+  // Inspects a code block, bypassing the cache.
+  DecompositionDecision GetCodeBlockDecompositionDecision(
+      const BlockGraph::Block* code_block) const;
   // Checks that the attributes (derived from symbol data) are consistent.
   static bool CodeBlockAttributesAreBasicBlockSafe(
       const BlockGraph::Block* code_block,
@@ -72,9 +114,16 @@ class PETransformPolicy : public block_graph::TransformPolicyInterface {
       const BlockGraph::Block* code_block);
 
  protected:
+  // A cached decision, along with the version of the block it was made for.
+  struct CachedDecision {
+    uint32_t change_count;
+    DecompositionDecision decision;
+  };
+
   // Block IDs are stable, unique and can't be reused. That makes them perfect
-  // for a cache ID.
-  typedef std::map<const BlockGraph::BlockId, bool> BlockResultCache;
+  // for a cache ID. The change count of a block tells whether the cached
+  // decision is still current.
+  typedef std::map<const BlockGraph::BlockId, CachedDecision> BlockResultCache;
   std::unique_ptr<BlockResultCache> block_result_cache_;
 
   // Determines whether or not we will allow decomposition of blocks with
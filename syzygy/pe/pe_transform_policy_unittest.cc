@@ -544,15 +544,56 @@ TEST_F(PETransformPolicyTest, CodeBlockIsSafeToBasicBlockDecomposeCache) {
       policy.block_result_cache_->find(code->id());
   ASSERT_NE(policy.block_result_cache_->end(), it);
   EXPECT_EQ(code->id(), it->first);
-  EXPECT_TRUE(it->second);
+  EXPECT_EQ(code->change_count(), it->second.change_count);
+  EXPECT_EQ(TestPETransformPolicy::kSafe, it->second.decision);
 
-  // Add an unreferenced data label. This should make the analysis fail.
-  // However, it should be looked up in the cache and return true.
+  // Asking again is answered from the cache.
+  EXPECT_EQ(TestPETransformPolicy::kSafe,
+            policy.GetDecompositionDecision(code));
+  EXPECT_EQ(1u, policy.block_result_cache_->size());
+
+  // Add an unreferenced data label. This should make the analysis fail, and
+  // the change to the block invalidates the cached decision.
   ASSERT_TRUE(code->SetLabel(1, BlockGraph::Label(
       "data", BlockGraph::DATA_LABEL)));
   ASSERT_FALSE(policy.CodeBlockIsSafeToBasicBlockDecompose(code));
-  ASSERT_TRUE(policy.BlockIsSafeToBasicBlockDecompose(code));
+  ASSERT_FALSE(policy.BlockIsSafeToBasicBlockDecompose(code));
+  EXPECT_EQ(TestPETransformPolicy::kUnsafeReferrers,
+            policy.GetDecompositionDecision(code));
   EXPECT_EQ(1u, policy.block_result_cache_->size());
+  it = policy.block_result_cache_->find(code->id());
+  ASSERT_NE(policy.block_result_cache_->end(), it);
+  EXPECT_EQ(code->change_count(), it->second.change_count);
+  EXPECT_EQ(TestPETransformPolicy::kUnsafeReferrers, it->second.decision);
+}
+
+TEST_F(PETransformPolicyTest, GetDecompositionDecision) {
+  TestPETransformPolicy policy;
+
+  BlockGraph::Block* data = image_.AddBlock(BlockGraph::DATA_BLOCK, 1, "d");
+  EXPECT_EQ(TestPETransformPolicy::kUnsafeNotCodeBlock,
+            policy.GetDecompositionDecision(data));
+
+  BlockGraph::Block* code = image_.AddBlock(BlockGraph::CODE_BLOCK, 2, "c");
+  EXPECT_EQ(TestPETransformPolicy::kUnsafeNoPrivateSymbols,
+            policy.GetDecompositionDecision(code));
+
+  code->SetLabel(0, "code", BlockGraph::CODE_LABEL);
+  EXPECT_EQ(TestPETransformPolicy::kSafe,
+            policy.GetDecompositionDecision(code));
+
+  code->set_attribute(BlockGraph::HAS_EXCEPTION_HANDLING);
+  EXPECT_EQ(TestPETransformPolicy::kUnsafeAttributes,
+            policy.GetDecompositionDecision(code));
+
+  code->set_attribute(BlockGraph::BUILT_BY_SYZYGY);
+  EXPECT_EQ(TestPETransformPolicy::kSafeBuiltBySyzygy,
+            policy.GetDecompositionDecision(code));
+
+  EXPECT_FALSE(TestPETransformPolicy::DecisionIsSafe(
+      TestPETransformPolicy::kUnsafeLayout));
+  EXPECT_STREQ("no private symbols", TestPETransformPolicy::DecisionToString(
+      TestPETransformPolicy::kUnsafeNoPrivateSymbols));
 }
 
 TEST_F(PETransformPolicyTest,
@@ -569,7 +610,7 @@ TEST_F(PETransformPolicyTest,
       policy.block_result_cache_->find(code->id());
   ASSERT_NE(policy.block_result_cache_->end(), it);
   EXPECT_EQ(code->id(), it->first);
-  EXPECT_TRUE(it->second);
+  EXPECT_EQ(TestPETransformPolicy::kSafe, it->second.decision);
 
   // Set an attribute that disqualifies decomposition. This should return false
   // from both functions, ignoring the cached result.
@@ -14,8 +14,12 @@
 
 #include "syzygy/playback/playback.h"
 
+#include "base/bind.h"
+#include "base/callback.h"
+#include "base/threading/simple_thread.h"
 #include "syzygy/core/address.h"
 #include "syzygy/pdb/omap.h"
+#include "syzygy/pe/decomposition_cache.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/pe/metadata.h"
 #include "syzygy/pe/pe_file.h"
@@ -24,12 +28,40 @@ namespace playback {
 
 using trace::parser::Parser;
 
+namespace {
+
+// Runs a loading step on a thread of its own.
+class LoadRunner : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit LoadRunner(const base::Callback<bool(void)>& load)
+      : load_(load), succeeded_(false) {
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override { succeeded_ = load_.Run(); }
+  // @}
+
+  // @returns true if the step succeeded. Only valid once the thread joined.
+  bool succeeded() const { return succeeded_; }
+
+ private:
+  base::Callback<bool(void)> load_;
+  bool succeeded_;
+
+  DISALLOW_COPY_AND_ASSIGN(LoadRunner);
+};
+
+}  // namespace
+
 Playback::Playback(const base::FilePath& module_path,
                    const base::FilePath& instrumented_path,
                    const TraceFileList& trace_files)
     : module_path_(module_path),
       instrumented_path_(instrumented_path),
       trace_files_(trace_files),
+      decomposition_cache_(
+          pe::DecompositionCache::GetDirectoryFromEnvironment()),
       pe_file_(NULL),
       image_(NULL),
       parser_(NULL) {
@@ -61,9 +93,18 @@ bool Playback::Init(PEFile* pe_file, ImageLayout* image, Parser* parser) {
     return false;
   if (!InitializeParser())
     return false;
-  if (!LoadInstrumentedOmap())
-    return false;
-  if (!DecomposeImage())
+
+  // The OMAP information of the instrumented module and the decomposition of
+  // the original one are independent, so read the former while decomposing.
+  // The decomposition can't be interrupted, so a failure to read the OMAP
+  // information is only reported once it's done.
+  LoadRunner omap_loader(
+      base::Bind(&Playback::LoadInstrumentedOmap, base::Unretained(this)));
+  base::DelegateSimpleThread omap_thread(&omap_loader, "OmapLoader");
+  omap_thread.Start();
+  bool decomposed = DecomposeImage();
+  omap_thread.Join();
+  if (!omap_loader.succeeded() || !decomposed)
     return false;
 
   return true;
@@ -143,6 +184,9 @@ bool Playback::LoadInstrumentedOmap() {
   }
   LOG(INFO) << "Read OMAP data from instrumented module PDB.";
 
+  // Every traced function address gets translated, so index OMAPTO.
+  omap_to_index_.Init(omap_to_);
+
   return true;
 }
 
@@ -157,6 +201,7 @@ bool Playback::DecomposeImage() {
   // to actual Blocks.
   LOG(INFO) << "Decomposing input image: " << module_path_.value();
   Decomposer decomposer(*pe_file_);
+  decomposer.set_cache_directory(decomposition_cache_);
   if (!decomposer.Decompose(&image)) {
     LOG(ERROR) << "Unable to decompose input image: " << module_path_.value();
     return false;
@@ -170,6 +215,10 @@ bool Playback::DecomposeImage() {
     return false;
   }
 
+  // The copy isn't frozen. Every traced function is looked up by address,
+  // so build the lookup index of the address space once.
+  image_->blocks.Freeze();
+
   return true;
 }
 
@@ -257,7 +306,7 @@ const Playback::BlockGraph::Block* Playback::FindFunctionBlock(
 
   // Convert the address from one in the instrumented module to one in the
   // original module using the OMAP data.
-  rva = pdb::TranslateAddressViaOmap(omap_to(), rva);
+  rva = omap_to_index_.Translate(rva);
 
   // Get the block that this function call refers to.
   const BlockGraph::Block* block = image_->blocks.GetBlockByAddress(rva);
@@ -19,6 +19,10 @@
 // and provides functionality for mapping trace events back to
 // addresses/blocks in the original module.
 //
+// The original module is decomposed through the decomposition cache shared
+// with the other tools, while the OMAP information of the instrumented module
+// is read on another thread.
+//
 // Playback playback(module_path, instrumented_path, trace_files);
 // playback.Init(pe_file, image, parser)
 // playback.ConsumeCallTraceEvents()
@@ -69,6 +73,14 @@ class Playback {
   bool MatchesInstrumentedModuleSignature(
       const ModuleInformation& module_info) const;
 
+  // Sets the directory of the decomposition cache. This defaults to the
+  // directory named by pe::DecompositionCache::kCacheDirectoryEnvVar. When
+  // it's empty no cache is used. This must be called before Init.
+  // @param decomposition_cache the directory holding the cache entries.
+  void set_decomposition_cache(const base::FilePath& decomposition_cache) {
+    decomposition_cache_ = decomposition_cache;
+  }
+
   // Gets a code block from our image from its function address and process id.
   // @param process_id The process id of the module where the function resides.
   // @param function The relative address of the function we are searching.
@@ -90,6 +102,9 @@ class Playback {
   const std::vector<OMAP>& omap_to() const { return omap_to_; }
   const std::vector<OMAP>& omap_from() const { return omap_from_; }
   const PEFile::Signature& instr_signature() const { return instr_signature_; }
+  const base::FilePath& decomposition_cache() const {
+    return decomposition_cache_;
+  }
   // @}
 
  protected:
@@ -119,6 +134,9 @@ class Playback {
   base::FilePath instrumented_path_;
   TraceFileList trace_files_;
 
+  // The directory of the decomposition cache, or empty if there is none.
+  base::FilePath decomposition_cache_;
+
   // This is a copy of the parser used to decompose the image, which needs
   // to be initialized with a ParseEventHandler before being used.
   Parser* parser_;
@@ -138,6 +156,9 @@ class Playback {
   std::vector<OMAP> omap_to_;
   std::vector<OMAP> omap_from_;
 
+  // An index over omap_to_, for the many translations of trace events.
+  pdb::OmapIndex omap_to_index_;
+
   // Signature of the instrumented DLL. Used for filtering call-trace events.
   PEFile::Signature instr_signature_;
 };
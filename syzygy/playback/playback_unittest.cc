@@ -16,10 +16,12 @@
 
 #include <string>
 
+#include "base/files/file_util.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
 #include "syzygy/pdb/omap.h"
+#include "syzygy/pe/decomposition_cache.h"
 #include "syzygy/pe/pe_file.h"
 #include "syzygy/pe/unittest_util.h"
 #include "syzygy/trace/parse/parse_engine.h"
@@ -120,6 +122,27 @@ TEST_F(PlaybackTest, BadTraceFile) {
 TEST_F(PlaybackTest, SuccessfulInit) {
   EXPECT_TRUE(Init());
   EXPECT_TRUE(playback_->Init(&input_dll_, &image_layout_, parser_.get()));
+
+  // The OMAP information was read alongside the decomposition, and the image
+  // is ready for lookups.
+  EXPECT_FALSE(playback_->omap_to().empty());
+  EXPECT_FALSE(playback_->omap_from().empty());
+  EXPECT_TRUE(image_layout_.blocks.address_space_impl().frozen());
+}
+
+TEST_F(PlaybackTest, InitPopulatesDecompositionCache) {
+  base::FilePath cache_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&cache_dir));
+
+  EXPECT_TRUE(Init());
+  playback_->set_decomposition_cache(cache_dir);
+  EXPECT_EQ(cache_dir, playback_->decomposition_cache());
+  EXPECT_TRUE(playback_->Init(&input_dll_, &image_layout_, parser_.get()));
+
+  pe::DecompositionCache cache(cache_dir);
+  base::FilePath entry_path;
+  ASSERT_TRUE(cache.GetEntryPath(input_dll_, &entry_path));
+  EXPECT_TRUE(base::PathExists(entry_path));
 }
 
 TEST_F(PlaybackTest, ConsumeCallTraceEvents) {
@@ -14,9 +14,20 @@
 
 #include "syzygy/poirot/poirot_app.h"
 
+#include <algorithm>
+#include <string>
+
 #include "base/at_exit.h"
 #include "base/command_line.h"
+#include "base/sys_info.h"
+#include "base/files/file_enumerator.h"
 #include "base/files/file_util.h"
+#include "base/json/string_escape.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/strings/stringprintf.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/simple_thread.h"
 
 namespace poirot {
 
@@ -27,16 +38,95 @@ const char kUsageFormatStr[] =
     "\n"
     "  Read a minidump and extract the Kasko protobuf that is in it.\n"
     "\n"
-    "Required parameters\n"
+    "Required parameters, exactly one of\n"
     "  --input-minidump=<image file>\n"
     "      The minidump to process.\n"
+    "  --input-dir=<directory>\n"
+    "      Process the minidumps (*.dmp) of a directory in batch mode.\n"
+    "  --input-list=<file>\n"
+    "      Process the minidumps listed in a file, one path per line, in\n"
+    "      batch mode.\n"
     "Optional parameters\n"
     "  --output-file=<output file>\n"
     "      Optionally provide the name or path to the output file. If not\n"
-    "      provided, output will be to standard out.\n";
+    "      provided, output will be to standard out.\n"
+    "  --worker-count=<count>\n"
+    "      The number of minidumps processed concurrently in batch mode.\n"
+    "      Defaults to the number of processors.\n"
+    "\n"
+    "  In batch mode, each minidump yields a line of JSON as it completes:\n"
+    "  {\"minidump\": <path>, \"crash-data\": <crash data>} on success, or\n"
+    "  {\"minidump\": <path>, \"error\": <message>} on failure.\n";
+
+// Processes @p minidump.
+// @param minidump the minidump to process.
+// @param line receives the line of JSON describing the result.
+// @returns true on success, false otherwise.
+bool ProcessBatchMinidump(const base::FilePath& minidump, std::string* line) {
+  DCHECK_NE(static_cast<std::string*>(nullptr), line);
+
+  // Invalid characters are replaced, which is fine to identify the minidump.
+  std::string escaped_path;
+  base::EscapeJSONString(minidump.AsUTF8Unsafe(), true, &escaped_path);
+
+  MinidumpProcessor processor(minidump);
+  std::string json;
+  if (!processor.ProcessDump() || !processor.GetJson(false, &json)) {
+    *line = base::StringPrintf(
+        "{\"minidump\": %s, \"error\": \"Unable to process the minidump.\"}",
+        escaped_path.c_str());
+    return false;
+  }
+
+  *line = base::StringPrintf("{\"minidump\": %s, \"crash-data\": %s}",
+                             escaped_path.c_str(), json.c_str());
+  return true;
+}
 
 }  // namespace
 
+// Processes one minidump per call to Run, and writes its result as soon as
+// it's available.
+class PoirotApp::ProcessDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  ProcessDelegate(const std::vector<base::FilePath>& minidumps, FILE* output)
+      : minidumps_(minidumps),
+        output_(output),
+        next_minidump_(0U),
+        failure_count_(0U) {
+    DCHECK_NE(static_cast<FILE*>(nullptr), output);
+  }
+
+  void Run() override {
+    base::FilePath minidump;
+    {
+      base::AutoLock auto_lock(lock_);
+      DCHECK_LT(next_minidump_, minidumps_.size());
+      minidump = minidumps_[next_minidump_++];
+    }
+
+    std::string line;
+    bool succeeded = ProcessBatchMinidump(minidump, &line);
+
+    base::AutoLock auto_lock(lock_);
+    ::fprintf(output_, "%s\n", line.c_str());
+    ::fflush(output_);
+    if (!succeeded)
+      ++failure_count_;
+  }
+
+  size_t failure_count() const { return failure_count_; }
+
+ private:
+  const std::vector<base::FilePath>& minidumps_;
+  FILE* output_;  // Written under lock_.
+  base::Lock lock_;
+  size_t next_minidump_;  // Under lock_.
+  size_t failure_count_;  // Under lock_.
+
+  DISALLOW_COPY_AND_ASSIGN(ProcessDelegate);
+};
+
 void PoirotApp::PrintUsage(const base::FilePath& program,
                            const base::StringPiece& message) {
   if (!message.empty()) {
@@ -56,11 +146,34 @@ bool PoirotApp::ParseCommandLine(const base::CommandLine* cmd_line) {
   }
 
   input_minidump_ = cmd_line->GetSwitchValuePath("input-minidump");
-  if (input_minidump_.empty()) {
+  input_dir_ = cmd_line->GetSwitchValuePath("input-dir");
+  input_list_ = cmd_line->GetSwitchValuePath("input-list");
+  int input_count = !input_minidump_.empty() + !input_dir_.empty() +
+                    !input_list_.empty();
+  if (input_count == 0) {
     PrintUsage(cmd_line->GetProgram(),
                "Must specify '--input-minidump' parameter!");
     return false;
   }
+  if (input_count > 1) {
+    PrintUsage(cmd_line->GetProgram(),
+               "Must specify only one of '--input-minidump', '--input-dir' "
+               "and '--input-list'!");
+    return false;
+  }
+
+  worker_count_ = base::SysInfo::NumberOfProcessors();
+  if (cmd_line->HasSwitch("worker-count")) {
+    unsigned worker_count = 0;
+    if (!base::StringToUint(cmd_line->GetSwitchValueASCII("worker-count"),
+                            &worker_count) ||
+        worker_count == 0) {
+      PrintUsage(cmd_line->GetProgram(),
+                 "'--worker-count' must be a positive number!");
+      return false;
+    }
+    worker_count_ = worker_count;
+  }
 
   // If no output file is specified stdout will be used.
   output_file_ = cmd_line->GetSwitchValuePath("output-file");
@@ -89,6 +202,13 @@ int PoirotApp::Run() {
     output_file = scoped_file.get();
   }
 
+  if (input_minidump_.empty()) {
+    std::vector<base::FilePath> minidumps;
+    if (!GetBatchMinidumps(&minidumps))
+      return 1;
+    return ProcessBatch(minidumps, output_file) ? 0 : 1;
+  }
+
   // Do the processing.
   MinidumpProcessor processor(input_minidump_);
   if (!processor.ProcessDump())
@@ -101,4 +221,67 @@ int PoirotApp::Run() {
   return 0;
 }
 
+bool PoirotApp::GetBatchMinidumps(std::vector<base::FilePath>* minidumps) {
+  DCHECK_NE(static_cast<std::vector<base::FilePath>*>(nullptr), minidumps);
+  minidumps->clear();
+
+  if (!input_dir_.empty()) {
+    if (!base::DirectoryExists(input_dir_)) {
+      LOG(ERROR) << "Unable to find input directory '" << input_dir_.value()
+                 << "'.";
+      return false;
+    }
+
+    base::FileEnumerator enumerator(input_dir_, false,
+                                    base::FileEnumerator::FILES, L"*.dmp");
+    for (base::FilePath path = enumerator.Next(); !path.empty();
+         path = enumerator.Next()) {
+      minidumps->push_back(path);
+    }
+    // The enumeration order is unspecified.
+    std::sort(minidumps->begin(), minidumps->end());
+    return true;
+  }
+
+  DCHECK(!input_list_.empty());
+  std::string list;
+  if (!base::ReadFileToString(input_list_, &list)) {
+    LOG(ERROR) << "Unable to read input list '" << input_list_.value()
+               << "'.";
+    return false;
+  }
+
+  for (const std::string& path :
+       base::SplitString(list, "\r\n", base::TRIM_WHITESPACE,
+                         base::SPLIT_WANT_NONEMPTY)) {
+    minidumps->push_back(base::FilePath::FromUTF8Unsafe(path));
+  }
+  return true;
+}
+
+bool PoirotApp::ProcessBatch(const std::vector<base::FilePath>& minidumps,
+                             FILE* output) {
+  DCHECK_NE(static_cast<FILE*>(nullptr), output);
+
+  ProcessDelegate delegate(minidumps, output);
+  if (worker_count_ == 1 || minidumps.size() <= 1) {
+    for (size_t i = 0; i < minidumps.size(); ++i)
+      delegate.Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "PoirotApp",
+        static_cast<int>(std::min(worker_count_, minidumps.size())));
+    pool.Start();
+    pool.AddWork(&delegate, static_cast<int>(minidumps.size()));
+    pool.JoinAll();
+  }
+
+  if (delegate.failure_count() != 0) {
+    LOG(ERROR) << "Unable to process " << delegate.failure_count() << " of "
+               << minidumps.size() << " minidumps.";
+    return false;
+  }
+  return true;
+}
+
 }  // namespace poirot
@@ -15,6 +15,9 @@
 #ifndef SYZYGY_POIROT_POIROT_APP_H_
 #define SYZYGY_POIROT_POIROT_APP_H_
 
+#include <stdio.h>
+#include <vector>
+
 #include "base/command_line.h"
 #include "base/files/file_path.h"
 #include "base/strings/string_piece.h"
@@ -31,7 +34,7 @@ class PoirotApp : public application::AppImplBase {
  public:
   // @name Implementation of the AppImplBase interface.
   // @{
-  PoirotApp() : application::AppImplBase("PoirotApp") {}
+  PoirotApp() : application::AppImplBase("PoirotApp"), worker_count_(1U) {}
 
   bool ParseCommandLine(const base::CommandLine* command_line);
 
@@ -43,15 +46,34 @@ class PoirotApp : public application::AppImplBase {
   // @{
   void PrintUsage(const base::FilePath& program,
                   const base::StringPiece& message);
+
+  // Gets the minidumps to process in batch mode, from input_dir_ or
+  // input_list_.
+  // @param minidumps receives the paths of the minidumps.
+  // @returns true on success, false otherwise.
+  bool GetBatchMinidumps(std::vector<base::FilePath>* minidumps);
+
+  // Processes @p minidumps on worker_count_ threads, and writes a line of JSON
+  // to @p output for each of them, as they complete.
+  // @param minidumps the minidumps to process.
+  // @param output the file receiving the results.
+  // @returns true if all the minidumps were processed, false otherwise.
+  bool ProcessBatch(const std::vector<base::FilePath>& minidumps,
+                    FILE* output);
   // @}
 
   // @name Command-line options.
   // @{
   base::FilePath input_minidump_;
+  base::FilePath input_dir_;
+  base::FilePath input_list_;
   base::FilePath output_file_;
+  size_t worker_count_;
   // @}
 
  private:
+  class ProcessDelegate;
+
   DISALLOW_COPY_AND_ASSIGN(PoirotApp);
 };
 
@@ -14,6 +14,9 @@
 
 #include "syzygy/poirot/poirot_app.h"
 
+#include "base/files/file_util.h"
+#include "base/strings/string_split.h"
+#include "base/strings/string_util.h"
 #include "gtest/gtest.h"
 #include "syzygy/common/unittest_util.h"
 #include "syzygy/core/unittest_util.h"
@@ -25,8 +28,11 @@ namespace {
 
 class TestPoirotApp : public PoirotApp {
  public:
+  using PoirotApp::input_dir_;
+  using PoirotApp::input_list_;
   using PoirotApp::input_minidump_;
   using PoirotApp::output_file_;
+  using PoirotApp::worker_count_;
 };
 
 typedef application::Application<TestPoirotApp> TestApp;
@@ -80,6 +86,14 @@ class PoirotAppTest : public testing::ApplicationTestBase {
   base::CommandLine cmd_line_;
 };
 
+// Reads the lines of JSON written to @p path.
+std::vector<std::string> ReadLines(const base::FilePath& path) {
+  std::string file_content;
+  EXPECT_TRUE(base::ReadFileToString(path, &file_content));
+  return base::SplitString(file_content, "\n", base::KEEP_WHITESPACE,
+                           base::SPLIT_WANT_NONEMPTY);
+}
+
 }  // namespace
 
 TEST_F(PoirotAppTest, GetHelp) {
@@ -145,4 +159,76 @@ TEST_F(PoirotAppTest, WriteJsonOutput) {
   EXPECT_FALSE(file_content.empty());
 }
 
+TEST_F(PoirotAppTest, ParseBatchCommandLineSucceeds) {
+  cmd_line_.AppendSwitchPath("input-dir", temp_dir_);
+  cmd_line_.AppendSwitchASCII("worker-count", "3");
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_SAME_FILE(temp_dir_, test_impl_.input_dir_);
+  EXPECT_TRUE(test_impl_.input_minidump_.empty());
+  EXPECT_EQ(3U, test_impl_.worker_count_);
+}
+
+TEST_F(PoirotAppTest, ParseSeveralInputsFails) {
+  cmd_line_.AppendSwitchPath("input-minidump",
+      testing::GetSrcRelativePath(testing::kMinidumpUAF));
+  cmd_line_.AppendSwitchPath("input-dir", temp_dir_);
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(PoirotAppTest, ParseInvalidWorkerCountFails) {
+  cmd_line_.AppendSwitchPath("input-dir", temp_dir_);
+  cmd_line_.AppendSwitchASCII("worker-count", "0");
+  EXPECT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(PoirotAppTest, ProcessDirectoryWritesJsonLines) {
+  // The test data holds a minidump with no Kasko stream, which fails.
+  base::FilePath output = temp_dir_.Append(L"batch.json");
+  cmd_line_.AppendSwitchPath("input-dir",
+      testing::GetSrcRelativePath(testing::kMinidumpUAF).DirName());
+  cmd_line_.AppendSwitchPath("output-file", output);
+  cmd_line_.AppendSwitchASCII("worker-count", "2");
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_NE(0, test_impl_.Run());
+
+  std::vector<std::string> lines = ReadLines(output);
+  ASSERT_EQ(2U, lines.size());
+  size_t failure_count = 0;
+  for (const std::string& line : lines) {
+    EXPECT_TRUE(base::StartsWith(line, "{\"minidump\": ",
+                                 base::CompareCase::SENSITIVE));
+    if (line.find("\"error\"") != std::string::npos)
+      ++failure_count;
+    else
+      EXPECT_NE(std::string::npos, line.find("\"crash-data\""));
+  }
+  EXPECT_EQ(1U, failure_count);
+}
+
+TEST_F(PoirotAppTest, ProcessListSucceeds) {
+  std::string path =
+      testing::GetSrcRelativePath(testing::kMinidumpUAF).AsUTF8Unsafe();
+  std::string list = path + "\n\n" + path + "\r\n";
+  base::FilePath list_path = temp_dir_.Append(L"list.txt");
+  ASSERT_EQ(static_cast<int>(list.size()),
+            base::WriteFile(list_path, list.data(), list.size()));
+
+  base::FilePath output = temp_dir_.Append(L"batch.json");
+  cmd_line_.AppendSwitchPath("input-list", list_path);
+  cmd_line_.AppendSwitchPath("output-file", output);
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(0, test_impl_.Run());
+
+  std::vector<std::string> lines = ReadLines(output);
+  ASSERT_EQ(2U, lines.size());
+  EXPECT_EQ(lines[0], lines[1]);
+  EXPECT_NE(std::string::npos, lines[0].find("\"crash-data\""));
+}
+
+TEST_F(PoirotAppTest, ProcessMissingListFails) {
+  cmd_line_.AppendSwitchPath("input-list", temp_dir_.Append(L"missing.txt"));
+  EXPECT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_NE(0, test_impl_.Run());
+}
+
 }  // namespace poirot
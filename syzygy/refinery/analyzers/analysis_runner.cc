@@ -14,36 +14,186 @@
 
 #include "syzygy/refinery/analyzers/analysis_runner.h"
 
-#include "base/stl_util.h"
+#include <algorithm>
+#include <set>
+
+#include "base/synchronization/condition_variable.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/simple_thread.h"
 
 namespace refinery {
 
-AnalysisRunner::AnalysisRunner() {
+namespace {
+
+// Runs @p analyzer.
+// @returns true on success, false on failure.
+bool RunAnalyzer(Analyzer* analyzer,
+                 const minidump::Minidump& minidump,
+                 const Analyzer::ProcessAnalysis& process_analysis) {
+  DCHECK(analyzer);
+
+  Analyzer::AnalysisResult result =
+      analyzer->Analyze(minidump, process_analysis);
+  CHECK(result != Analyzer::ANALYSIS_ITERATE)
+      << "Iterative analysis is not supported.";
+  if (result != Analyzer::ANALYSIS_COMPLETE) {
+    LOG(ERROR) << analyzer->name() << " analysis failed";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+// Runs one analyzer per call to Run, once all the analyzers it depends on
+// completed. Once an analyzer fails, the pending calls to Run return without
+// running anything.
+class AnalysisRunner::AnalyzeDelegate
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  AnalyzeDelegate(const std::vector<Entry>& entries,
+                  const minidump::Minidump& minidump,
+                  const Analyzer::ProcessAnalysis& process_analysis)
+      : entries_(entries),
+        minidump_(minidump),
+        process_analysis_(process_analysis),
+        dependents_(entries.size()),
+        pending_counts_(entries.size(), 0),
+        ready_condition_(&lock_),
+        failed_(false) {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      for (size_t j = 0; j < i; ++j) {
+        if (Conflicts(entries_[j], entries_[i])) {
+          dependents_[j].push_back(i);
+          ++pending_counts_[i];
+        }
+      }
+      if (pending_counts_[i] == 0)
+        ready_.insert(i);
+    }
+  }
+
+  void Run() override {
+    size_t index = 0;
+    {
+      base::AutoLock auto_lock(lock_);
+      while (ready_.empty() && !failed_)
+        ready_condition_.Wait();
+      if (failed_)
+        return;
+
+      // Run the analyzers in the order they were added, when possible.
+      index = *ready_.begin();
+      ready_.erase(ready_.begin());
+    }
+
+    bool succeeded =
+        RunAnalyzer(entries_[index].analyzer, minidump_, process_analysis_);
+
+    {
+      base::AutoLock auto_lock(lock_);
+      if (succeeded) {
+        for (size_t dependent : dependents_[index]) {
+          DCHECK_LT(0U, pending_counts_[dependent]);
+          if (--pending_counts_[dependent] == 0)
+            ready_.insert(dependent);
+        }
+      } else {
+        failed_ = true;
+      }
+    }
+    ready_condition_.Broadcast();
+  }
+
+  bool failed() const { return failed_; }
+
+ private:
+  const std::vector<Entry>& entries_;
+  const minidump::Minidump& minidump_;
+  const Analyzer::ProcessAnalysis& process_analysis_;
+
+  // The analyzers that depend on each analyzer.
+  std::vector<std::vector<size_t>> dependents_;
+
+  base::Lock lock_;
+  // The number of analyzers each analyzer waits for. Under lock_.
+  std::vector<size_t> pending_counts_;
+  // The analyzers ready to run. Under lock_.
+  std::set<size_t> ready_;
+  // Signaled when analyzers become ready, or on failure.
+  base::ConditionVariable ready_condition_;
+  bool failed_;  // Under lock_.
+
+  DISALLOW_COPY_AND_ASSIGN(AnalyzeDelegate);
+};
+
+AnalysisRunner::AnalysisRunner() : worker_count_(1U) {
 }
 
 AnalysisRunner::~AnalysisRunner() {
-  STLDeleteElements(&analyzers_);
+  for (Entry& entry : entries_)
+    delete entry.analyzer;
 }
 
 void AnalysisRunner::AddAnalyzer(std::unique_ptr<Analyzer> analyzer) {
   DCHECK(analyzer);
-  analyzers_.push_back(analyzer.release());
+  Entry entry = { analyzer.release(), false, Layers() };
+  entries_.push_back(entry);
+}
+
+void AnalysisRunner::AddAnalyzer(std::unique_ptr<Analyzer> analyzer,
+                                 const Layers& input_layers,
+                                 const Layers& output_layers) {
+  DCHECK(analyzer);
+  Entry entry = { analyzer.release(), true, input_layers };
+  entry.layers.insert(entry.layers.end(), output_layers.begin(),
+                      output_layers.end());
+  std::sort(entry.layers.begin(), entry.layers.end());
+  entry.layers.erase(std::unique(entry.layers.begin(), entry.layers.end()),
+                     entry.layers.end());
+  entries_.push_back(entry);
 }
 
 Analyzer::AnalysisResult AnalysisRunner::Analyze(
     const minidump::Minidump& minidump,
     const Analyzer::ProcessAnalysis& process_analysis) {
-  for (Analyzer* analyzer : analyzers_) {
-    Analyzer::AnalysisResult result =
-        analyzer->Analyze(minidump, process_analysis);
-    CHECK(result != Analyzer::ANALYSIS_ITERATE)
-        << "Iterative analysis is not supported.";
-    if (result != Analyzer::ANALYSIS_COMPLETE) {
-      LOG(ERROR) << analyzer->name() << " analysis failed";
-      return Analyzer::ANALYSIS_ERROR;
+  if (worker_count_ == 1 || entries_.size() <= 1) {
+    for (const Entry& entry : entries_) {
+      if (!RunAnalyzer(entry.analyzer, minidump, process_analysis))
+        return Analyzer::ANALYSIS_ERROR;
     }
+    return Analyzer::ANALYSIS_COMPLETE;
   }
+
+  AnalyzeDelegate delegate(entries_, minidump, process_analysis);
+  base::DelegateSimpleThreadPool pool(
+      "AnalysisRunner",
+      static_cast<int>(std::min(worker_count_, entries_.size())));
+  pool.Start();
+  pool.AddWork(&delegate, static_cast<int>(entries_.size()));
+  pool.JoinAll();
+
+  if (delegate.failed())
+    return Analyzer::ANALYSIS_ERROR;
   return Analyzer::ANALYSIS_COMPLETE;
 }
 
+bool AnalysisRunner::Conflicts(const Entry& first, const Entry& second) {
+  if (!first.has_layers || !second.has_layers)
+    return true;
+
+  // Both layer lists are sorted.
+  auto it1 = first.layers.begin();
+  auto it2 = second.layers.begin();
+  while (it1 != first.layers.end() && it2 != second.layers.end()) {
+    if (*it1 == *it2)
+      return true;
+    if (*it1 < *it2)
+      ++it1;
+    else
+      ++it2;
+  }
+  return false;
+}
+
 }  // namespace refinery
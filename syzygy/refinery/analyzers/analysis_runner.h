@@ -27,18 +27,37 @@ namespace refinery {
 
 // The analysis runner runs analyzers over a minidump to populate a process
 // state.
+//
+// Analyzers may declare the layers they read and write, in which case the
+// runner schedules them on a pool of worker threads. An analyzer runs after
+// every previously added analyzer that shares a layer with it, be it as input
+// or output, so that a layer is only ever used by one analyzer at a time, in
+// the order the analyzers were added. Analyzers added without layers run
+// alone, after every previously added analyzer.
 // TODO(manzagop): support iterative analysis (analyzers returning
 // ANALYSIS_ITERATE).
 class AnalysisRunner {
  public:
+  using Layers = std::vector<ProcessState::LayerEnum>;
+
   AnalysisRunner();
   ~AnalysisRunner();
 
-  // Adds @p analyzer to the runner.
+  // Adds @p analyzer to the runner, to run alone.
   // @param analyzer an analyzer to take ownership of. Deleted on runner's
   //   destruction.
   void AddAnalyzer(std::unique_ptr<Analyzer> analyzer);
 
+  // Adds @p analyzer to the runner, to run concurrently with the analyzers
+  // it shares no layer with.
+  // @param analyzer an analyzer to take ownership of. Deleted on runner's
+  //   destruction.
+  // @param input_layers the layers @p analyzer reads.
+  // @param output_layers the layers @p analyzer writes.
+  void AddAnalyzer(std::unique_ptr<Analyzer> analyzer,
+                   const Layers& input_layers,
+                   const Layers& output_layers);
+
   // Runs analyzers over @p minidump and updates the ProcessState supplied
   // through @p process_analysis.
   // @param minidump the minidump to analyze.
@@ -50,8 +69,35 @@ class AnalysisRunner {
       const minidump::Minidump& minidump,
       const Analyzer::ProcessAnalysis& process_analysis);
 
+  // @name Accessors and mutators.
+  // @{
+  size_t worker_count() const { return worker_count_; }
+  void set_worker_count(size_t worker_count) {
+    DCHECK_LT(0U, worker_count);
+    worker_count_ = worker_count;
+  }
+  // @}
+
  private:
-  std::vector<Analyzer*> analyzers_;  // Owned.
+  class AnalyzeDelegate;
+
+  struct Entry {
+    Analyzer* analyzer;  // Owned.
+    // Whether the analyzer declared its layers.
+    bool has_layers;
+    // The layers the analyzer reads or writes, sorted.
+    Layers layers;
+  };
+
+  // @returns true if the analyzers of @p first and @p second can't run
+  //     concurrently.
+  static bool Conflicts(const Entry& first, const Entry& second);
+
+  std::vector<Entry> entries_;
+
+  // The number of worker threads running the analyzers. With a single worker,
+  // the analyzers run in turn on the calling thread.
+  size_t worker_count_;
 
   DISALLOW_COPY_AND_ASSIGN(AnalysisRunner);
 };
@@ -14,6 +14,11 @@
 
 #include "syzygy/refinery/analyzers/analysis_runner.h"
 
+#include <vector>
+
+#include "base/synchronization/lock.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/time/time.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "syzygy/minidump/minidump.h"
@@ -46,6 +51,77 @@ MockAnalyzer* CreateMockAnalyzer(Analyzer::AnalysisResult result) {
   return analyzer;
 }
 
+// An analyzer that records the order analyzers complete in.
+class RecordingAnalyzer : public Analyzer {
+ public:
+  RecordingAnalyzer(size_t id,
+                    AnalysisResult result,
+                    base::Lock* lock,
+                    std::vector<size_t>* completed)
+      : id_(id), result_(result), lock_(lock), completed_(completed) {}
+
+  const char* name() const override { return "RecordingAnalyzer"; }
+
+  AnalysisResult Analyze(const minidump::Minidump& minidump,
+                         const ProcessAnalysis& process_analysis) override {
+    base::AutoLock auto_lock(*lock_);
+    completed_->push_back(id_);
+    return result_;
+  }
+
+ private:
+  size_t id_;
+  AnalysisResult result_;
+  base::Lock* lock_;
+  std::vector<size_t>* completed_;
+};
+
+// An analyzer that signals an event, then waits for another one.
+class RendezvousAnalyzer : public Analyzer {
+ public:
+  RendezvousAnalyzer(base::WaitableEvent* signaled, base::WaitableEvent* waited)
+      : signaled_(signaled), waited_(waited) {}
+
+  const char* name() const override { return "RendezvousAnalyzer"; }
+
+  AnalysisResult Analyze(const minidump::Minidump& minidump,
+                         const ProcessAnalysis& process_analysis) override {
+    signaled_->Signal();
+    if (!waited_->TimedWait(base::TimeDelta::FromSeconds(10)))
+      return ANALYSIS_ERROR;
+    return ANALYSIS_COMPLETE;
+  }
+
+ private:
+  base::WaitableEvent* signaled_;
+  base::WaitableEvent* waited_;
+};
+
+class AnalysisRunnerParallelTest : public testing::Test {
+ protected:
+  void AddAnalyzer(size_t id,
+                   Analyzer::AnalysisResult result,
+                   const AnalysisRunner::Layers& input_layers,
+                   const AnalysisRunner::Layers& output_layers) {
+    std::unique_ptr<Analyzer> analyzer(
+        new RecordingAnalyzer(id, result, &lock_, &completed_));
+    runner_.AddAnalyzer(std::move(analyzer), input_layers, output_layers);
+  }
+
+  // @returns the position of @p id in completed_, or -1 if it didn't run.
+  int Position(size_t id) {
+    for (size_t i = 0; i < completed_.size(); ++i) {
+      if (completed_[i] == id)
+        return static_cast<int>(i);
+    }
+    return -1;
+  }
+
+  AnalysisRunner runner_;
+  base::Lock lock_;
+  std::vector<size_t> completed_;
+};
+
 }  // namespace
 
 TEST(AnalysisRunnerTest, BasicSuccessTest) {
@@ -79,4 +155,72 @@ TEST(AnalysisRunnerTest, BasicErrorTest) {
   ASSERT_EQ(Analyzer::ANALYSIS_ERROR, runner.Analyze(minidump, analysis));
 }
 
+TEST_F(AnalysisRunnerParallelTest, DependentAnalyzersRunInOrder) {
+  using Layers = AnalysisRunner::Layers;
+  AddAnalyzer(0, Analyzer::ANALYSIS_COMPLETE, Layers(),
+              Layers{ProcessState::BytesLayer});
+  AddAnalyzer(1, Analyzer::ANALYSIS_COMPLETE, Layers(),
+              Layers{ProcessState::ModuleLayer});
+  AddAnalyzer(2, Analyzer::ANALYSIS_COMPLETE,
+              Layers{ProcessState::BytesLayer, ProcessState::ModuleLayer},
+              Layers{ProcessState::HeapMetadataLayer});
+  AddAnalyzer(3, Analyzer::ANALYSIS_COMPLETE,
+              Layers{ProcessState::HeapMetadataLayer}, Layers());
+  // An analyzer without layers runs after all others.
+  std::unique_ptr<Analyzer> analyzer(new RecordingAnalyzer(
+      4, Analyzer::ANALYSIS_COMPLETE, &lock_, &completed_));
+  runner_.AddAnalyzer(std::move(analyzer));
+  runner_.set_worker_count(4);
+
+  ProcessState process_state;
+  SimpleProcessAnalysis analysis(&process_state);
+  minidump::FileMinidump minidump;
+  ASSERT_EQ(Analyzer::ANALYSIS_COMPLETE, runner_.Analyze(minidump, analysis));
+
+  ASSERT_EQ(5U, completed_.size());
+  EXPECT_LT(Position(0), Position(2));
+  EXPECT_LT(Position(1), Position(2));
+  EXPECT_LT(Position(2), Position(3));
+  EXPECT_EQ(4, Position(4));
+}
+
+TEST_F(AnalysisRunnerParallelTest, ErrorSkipsDependentAnalyzers) {
+  using Layers = AnalysisRunner::Layers;
+  AddAnalyzer(0, Analyzer::ANALYSIS_ERROR, Layers(),
+              Layers{ProcessState::BytesLayer});
+  AddAnalyzer(1, Analyzer::ANALYSIS_COMPLETE,
+              Layers{ProcessState::BytesLayer}, Layers());
+  runner_.set_worker_count(2);
+
+  ProcessState process_state;
+  SimpleProcessAnalysis analysis(&process_state);
+  minidump::FileMinidump minidump;
+  ASSERT_EQ(Analyzer::ANALYSIS_ERROR, runner_.Analyze(minidump, analysis));
+
+  EXPECT_EQ(0, Position(0));
+  EXPECT_EQ(-1, Position(1));
+}
+
+TEST(AnalysisRunnerTest, IndependentAnalyzersRunConcurrently) {
+  // Each analyzer waits for the other to start, which only succeeds if they
+  // run concurrently.
+  base::WaitableEvent first_started(true, false);
+  base::WaitableEvent second_started(true, false);
+
+  AnalysisRunner runner;
+  std::unique_ptr<Analyzer> analyzer(
+      new RendezvousAnalyzer(&first_started, &second_started));
+  runner.AddAnalyzer(std::move(analyzer), AnalysisRunner::Layers(),
+                     AnalysisRunner::Layers{ProcessState::BytesLayer});
+  analyzer.reset(new RendezvousAnalyzer(&second_started, &first_started));
+  runner.AddAnalyzer(std::move(analyzer), AnalysisRunner::Layers(),
+                     AnalysisRunner::Layers{ProcessState::ModuleLayer});
+  runner.set_worker_count(2);
+
+  ProcessState process_state;
+  SimpleProcessAnalysis analysis(&process_state);
+  minidump::FileMinidump minidump;
+  ASSERT_EQ(Analyzer::ANALYSIS_COMPLETE, runner.Analyze(minidump, analysis));
+}
+
 }  // namespace refinery
@@ -98,9 +98,14 @@ Analyzer::AnalysisResult MemoryAnalyzer::Analyze(
     minidump::Minidump::Stream bytes_stream =
         minidump.GetStreamFor(descriptor.Memory);
 
+    // Copy the bytes straight out of minidumps held in memory.
     std::string bytes;
-    if (!bytes_stream.ReadAndAdvanceBytes(range_size, &bytes))
+    const uint8_t* data = nullptr;
+    if (bytes_stream.GetAndAdvanceBytes(range_size, &data)) {
+      bytes.assign(reinterpret_cast<const char*>(data), range_size);
+    } else if (!bytes_stream.ReadAndAdvanceBytes(range_size, &bytes)) {
       return ANALYSIS_ERROR;
+    }
 
     AddressRange new_range(range_addr, range_size);
     if (!new_range.IsValid())
@@ -24,6 +24,7 @@
 #include "base/command_line.h"
 #include "base/logging.h"
 #include "base/macros.h"
+#include "base/sys_info.h"
 #include "base/files/file_path.h"
 #include "base/json/string_escape.h"
 #include "base/strings/string16.h"
@@ -457,7 +458,7 @@ int RunAnalyzerApplication::Run() {
   for (const auto& minidump_path : mindump_paths_) {
     ::fprintf(out(), "Processing \"%ls\"\n", minidump_path.value().c_str());
 
-    minidump::FileMinidump minidump;
+    minidump::MappedMinidump minidump;
     if (!minidump.Open(minidump_path)) {
       LOG(ERROR) << "Unable to open dump file.";
       return 1;
@@ -483,12 +484,14 @@ bool RunAnalyzerApplication::AddAnalyzers(
   for (const auto& analyzer_name : analyzers) {
     std::unique_ptr<refinery::Analyzer> analyzer(
         factory.CreateAnalyzer(analyzer_name));
-    if (analyzer) {
-      runner->AddAnalyzer(std::move(analyzer));
-    } else {
+    refinery::AnalysisRunner::Layers input_layers;
+    refinery::AnalysisRunner::Layers output_layers;
+    if (!analyzer || !factory.GetInputLayers(analyzer_name, &input_layers) ||
+        !factory.GetOutputLayers(analyzer_name, &output_layers)) {
       LOG(ERROR) << "No such analyzer " << analyzer_name;
       return false;
     }
+    runner->AddAnalyzer(std::move(analyzer), input_layers, output_layers);
   }
 
   return true;
@@ -544,7 +547,9 @@ bool RunAnalyzerApplication::Analyze(
       "    AMDExtendedCpuFeatures 0x%08X",
       system_info.Cpu.X86CpuInfo.AMDExtendedCpuFeatures);
 
+  // The analyzers that share no layer run concurrently.
   refinery::AnalysisRunner runner;
+  runner.set_worker_count(base::SysInfo::NumberOfProcessors());
   if (!AddAnalyzers(factory, &runner))
     return false;
 
@@ -16,6 +16,7 @@
 
 #include <queue>
 
+#include "syzygy/refinery/process_state/caching_bit_source.h"
 #include "syzygy/refinery/process_state/process_state_util.h"
 #include "syzygy/refinery/process_state/refinery.pb.h"
 #include "syzygy/refinery/types/type.h"
@@ -52,6 +53,9 @@ Analyzer::AnalysisResult TypePropagatorAnalyzer::Analyze(
 
   ModuleLayerAccessor accessor(process_state);
 
+  // The propagation reads the bytes layer in many small pieces, and doesn't
+  // modify it.
+  CachingBitSource bit_source(process_state);
   std::queue<TypedData> process_queue;
 
   scoped_refptr<SymbolProvider> symbol_provider =
@@ -78,7 +82,7 @@ Analyzer::AnalysisResult TypePropagatorAnalyzer::Analyze(
       return ANALYSIS_ERROR;
 
     // Queue typed data for processing.
-    process_queue.push(TypedData(process_state, type, rec->range().start()));
+    process_queue.push(TypedData(&bit_source, type, rec->range().start()));
   }
 
   // Process typed data looking for pointers or contained pointers.
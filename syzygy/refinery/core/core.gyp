@@ -26,6 +26,12 @@
         'addressed_data.cc',
         'addressed_data.h',
         'bit_source.h',
+        'interval_tree.h',
+        'page_cache_bit_source.cc',
+        'page_cache_bit_source.h',
+      ],
+      'dependencies': [
+        '<(src)/base/base.gyp:base',
       ],
     },
   ],
@@ -0,0 +1,375 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SYZYGY_REFINERY_CORE_INTERVAL_TREE_H_
+#define SYZYGY_REFINERY_CORE_INTERVAL_TREE_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "syzygy/refinery/core/address.h"
+
+namespace refinery {
+
+// An interval tree indexes values by address range, and finds the values
+// whose range intersects or spans a given range in O(log n) time per result,
+// rather than scanning. It is a treap ordered by range start, where each node
+// is annotated with the largest range end of its subtree, so that subtrees
+// holding no result are skipped. The nodes are allocated from a pool that
+// recycles the nodes of removed values.
+//
+// A value may be indexed under several ranges, but a (range, value) pair may
+// only be indexed once. @p ValueType must be copyable and ordered by
+// std::less, such as a pointer.
+template <typename ValueType>
+class IntervalTree {
+ public:
+  IntervalTree() : root_(kNil), size_(0), seed_(0x9E3779B9U) {}
+
+  // Indexes @p value under @p range.
+  // @pre @p range must be valid, and (@p range, @p value) not indexed yet.
+  // @param range the range to index @p value under.
+  // @param value the value to index.
+  void Insert(const AddressRange& range, const ValueType& value);
+
+  // Removes @p value indexed under @p range.
+  // @param range the range @p value was indexed under.
+  // @param value the value to remove.
+  // @returns true on success, false if (@p range, @p value) isn't indexed.
+  bool Remove(const AddressRange& range, const ValueType& value);
+
+  // Finds the values whose range intersects @p range.
+  // @pre @p range must be valid.
+  // @param range the range to intersect.
+  // @param values receives the matching values, in increasing order of range
+  //     start. They are appended to the existing content.
+  void FindIntersecting(const AddressRange& range,
+                        std::vector<ValueType>* values) const;
+
+  // Finds the values whose range fully spans @p range.
+  // @pre @p range must be valid.
+  // @param range the range to span.
+  // @param values receives the matching values, in increasing order of range
+  //     start. They are appended to the existing content.
+  void FindSpanning(const AddressRange& range,
+                    std::vector<ValueType>* values) const;
+
+  // Removes all values.
+  void Clear();
+
+  // @returns the number of indexed values.
+  size_t size() const { return size_; }
+
+ private:
+  typedef uint32_t NodeIndex;
+  static const NodeIndex kNil = static_cast<NodeIndex>(-1);
+
+  struct Node {
+    Address start;
+    Address end;
+    // The largest end in the subtree rooted at this node.
+    Address max_end;
+    ValueType value;
+    uint32_t priority;
+    NodeIndex left;
+    NodeIndex right;
+  };
+
+  // @returns whether the node orders before (@p start, @p value).
+  bool NodeLess(const Node& node, Address start, const ValueType& value) const {
+    if (node.start != start)
+      return node.start < start;
+    return std::less<ValueType>()(node.value, value);
+  }
+
+  // Recomputes the max_end annotation of @p index from its children.
+  void Update(NodeIndex index);
+
+  // Rotates the subtree at @p index to the right or left.
+  // @returns the new root of the subtree.
+  NodeIndex RotateRight(NodeIndex index);
+  NodeIndex RotateLeft(NodeIndex index);
+
+  // Inserts @p new_node in the subtree at @p index.
+  // @returns the new root of the subtree.
+  NodeIndex InsertNode(NodeIndex index, NodeIndex new_node);
+
+  // Removes (@p start, @p value) from the subtree at @p index.
+  // @param removed set to the removed node, or kNil if none was.
+  // @returns the new root of the subtree.
+  NodeIndex RemoveNode(NodeIndex index,
+                       Address start,
+                       const ValueType& value,
+                       NodeIndex* removed);
+
+  // Merges the subtrees at @p left and @p right, where all of @p left orders
+  // before @p right.
+  // @returns the root of the merged subtree.
+  NodeIndex Merge(NodeIndex left, NodeIndex right);
+
+  void FindIntersecting(NodeIndex index,
+                        const AddressRange& range,
+                        std::vector<ValueType>* values) const;
+  void FindSpanning(NodeIndex index,
+                    const AddressRange& range,
+                    std::vector<ValueType>* values) const;
+
+  // Generates node priorities. An xorshift generator keeps the tree shape
+  // deterministic.
+  uint32_t NextPriority();
+
+  std::vector<Node> nodes_;
+  // The indices of the nodes of nodes_ that are free for reuse.
+  std::vector<NodeIndex> free_nodes_;
+  NodeIndex root_;
+  size_t size_;
+  uint32_t seed_;
+
+  DISALLOW_COPY_AND_ASSIGN(IntervalTree);
+};
+
+template <typename ValueType>
+void IntervalTree<ValueType>::Insert(const AddressRange& range,
+                                     const ValueType& value) {
+  DCHECK(range.IsValid());
+
+  NodeIndex index = kNil;
+  if (!free_nodes_.empty()) {
+    index = free_nodes_.back();
+    free_nodes_.pop_back();
+  } else {
+    CHECK_GT(static_cast<size_t>(kNil), nodes_.size());
+    index = static_cast<NodeIndex>(nodes_.size());
+    nodes_.push_back(Node());
+  }
+
+  Node& node = nodes_[index];
+  node.start = range.start();
+  node.end = range.end();
+  node.max_end = node.end;
+  node.value = value;
+  node.priority = NextPriority();
+  node.left = kNil;
+  node.right = kNil;
+
+  root_ = InsertNode(root_, index);
+  ++size_;
+}
+
+template <typename ValueType>
+bool IntervalTree<ValueType>::Remove(const AddressRange& range,
+                                     const ValueType& value) {
+  NodeIndex removed = kNil;
+  root_ = RemoveNode(root_, range.start(), value, &removed);
+  if (removed == kNil)
+    return false;
+
+  // Release the value, in case it holds a resource.
+  nodes_[removed].value = ValueType();
+  free_nodes_.push_back(removed);
+  --size_;
+  return true;
+}
+
+template <typename ValueType>
+void IntervalTree<ValueType>::FindIntersecting(
+    const AddressRange& range, std::vector<ValueType>* values) const {
+  DCHECK(range.IsValid());
+  DCHECK(values != nullptr);
+  FindIntersecting(root_, range, values);
+}
+
+template <typename ValueType>
+void IntervalTree<ValueType>::FindSpanning(
+    const AddressRange& range, std::vector<ValueType>* values) const {
+  DCHECK(range.IsValid());
+  DCHECK(values != nullptr);
+  FindSpanning(root_, range, values);
+}
+
+template <typename ValueType>
+void IntervalTree<ValueType>::Clear() {
+  nodes_.clear();
+  free_nodes_.clear();
+  root_ = kNil;
+  size_ = 0;
+}
+
+template <typename ValueType>
+void IntervalTree<ValueType>::Update(NodeIndex index) {
+  Node& node = nodes_[index];
+  node.max_end = node.end;
+  if (node.left != kNil)
+    node.max_end = std::max(node.max_end, nodes_[node.left].max_end);
+  if (node.right != kNil)
+    node.max_end = std::max(node.max_end, nodes_[node.right].max_end);
+}
+
+template <typename ValueType>
+typename IntervalTree<ValueType>::NodeIndex
+IntervalTree<ValueType>::RotateRight(NodeIndex index) {
+  NodeIndex left = nodes_[index].left;
+  nodes_[index].left = nodes_[left].right;
+  nodes_[left].right = index;
+  Update(index);
+  Update(left);
+  return left;
+}
+
+template <typename ValueType>
+typename IntervalTree<ValueType>::NodeIndex
+IntervalTree<ValueType>::RotateLeft(NodeIndex index) {
+  NodeIndex right = nodes_[index].right;
+  nodes_[index].right = nodes_[right].left;
+  nodes_[right].left = index;
+  Update(index);
+  Update(right);
+  return right;
+}
+
+template <typename ValueType>
+typename IntervalTree<ValueType>::NodeIndex
+IntervalTree<ValueType>::InsertNode(NodeIndex index, NodeIndex new_node) {
+  if (index == kNil)
+    return new_node;
+
+  const Node& inserted = nodes_[new_node];
+  if (NodeLess(inserted, nodes_[index].start, nodes_[index].value)) {
+    NodeIndex left = InsertNode(nodes_[index].left, new_node);
+    nodes_[index].left = left;
+    if (nodes_[left].priority > nodes_[index].priority)
+      return RotateRight(index);
+  } else {
+    DCHECK(NodeLess(nodes_[index], inserted.start, inserted.value));
+    NodeIndex right = InsertNode(nodes_[index].right, new_node);
+    nodes_[index].right = right;
+    if (nodes_[right].priority > nodes_[index].priority)
+      return RotateLeft(index);
+  }
+
+  Update(index);
+  return index;
+}
+
+template <typename ValueType>
+typename IntervalTree<ValueType>::NodeIndex
+IntervalTree<ValueType>::RemoveNode(NodeIndex index,
+                                    Address start,
+                                    const ValueType& value,
+                                    NodeIndex* removed) {
+  if (index == kNil)
+    return kNil;
+
+  Node& node = nodes_[index];
+  if (NodeLess(node, start, value)) {
+    NodeIndex right = RemoveNode(node.right, start, value, removed);
+    nodes_[index].right = right;
+  } else if (node.start != start ||
+             std::less<ValueType>()(value, node.value)) {
+    NodeIndex left = RemoveNode(node.left, start, value, removed);
+    nodes_[index].left = left;
+  } else {
+    *removed = index;
+    return Merge(node.left, node.right);
+  }
+
+  Update(index);
+  return index;
+}
+
+template <typename ValueType>
+typename IntervalTree<ValueType>::NodeIndex
+IntervalTree<ValueType>::Merge(NodeIndex left, NodeIndex right) {
+  if (left == kNil)
+    return right;
+  if (right == kNil)
+    return left;
+
+  if (nodes_[left].priority > nodes_[right].priority) {
+    NodeIndex merged = Merge(nodes_[left].right, right);
+    nodes_[left].right = merged;
+    Update(left);
+    return left;
+  }
+
+  NodeIndex merged = Merge(left, nodes_[right].left);
+  nodes_[right].left = merged;
+  Update(right);
+  return right;
+}
+
+template <typename ValueType>
+void IntervalTree<ValueType>::FindIntersecting(
+    NodeIndex index,
+    const AddressRange& range,
+    std::vector<ValueType>* values) const {
+  // Walk down the right spine iteratively, recursing into the left subtrees.
+  while (index != kNil) {
+    const Node& node = nodes_[index];
+
+    // Nothing in this subtree ends past the start of the range.
+    if (node.max_end <= range.start())
+      return;
+
+    FindIntersecting(node.left, range, values);
+
+    // This node and its right subtree start at or past the end of the range.
+    if (node.start >= range.end())
+      return;
+
+    if (node.end > range.start())
+      values->push_back(node.value);
+    index = node.right;
+  }
+}
+
+template <typename ValueType>
+void IntervalTree<ValueType>::FindSpanning(
+    NodeIndex index,
+    const AddressRange& range,
+    std::vector<ValueType>* values) const {
+  while (index != kNil) {
+    const Node& node = nodes_[index];
+
+    // Nothing in this subtree ends at or past the end of the range.
+    if (node.max_end < range.end())
+      return;
+
+    FindSpanning(node.left, range, values);
+
+    // This node and its right subtree start past the start of the range.
+    if (node.start > range.start())
+      return;
+
+    if (node.end >= range.end())
+      values->push_back(node.value);
+    index = node.right;
+  }
+}
+
+template <typename ValueType>
+uint32_t IntervalTree<ValueType>::NextPriority() {
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return seed_;
+}
+
+}  // namespace refinery
+
+#endif  // SYZYGY_REFINERY_CORE_INTERVAL_TREE_H_
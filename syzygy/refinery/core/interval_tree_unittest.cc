@@ -0,0 +1,157 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/refinery/core/interval_tree.h"
+
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace refinery {
+
+namespace {
+
+typedef IntervalTree<int> TestIntervalTree;
+typedef std::vector<std::pair<AddressRange, int>> RangeVector;
+
+// Finds the values of @p ranges intersecting or spanning @p range, the slow
+// way, in the order of the interval tree.
+std::vector<int> FindBruteForce(const RangeVector& ranges,
+                                const AddressRange& range,
+                                bool spanning) {
+  std::set<std::pair<Address, int>> matches;
+  for (const auto& entry : ranges) {
+    bool match = spanning ? entry.first.Contains(range)
+                          : entry.first.Intersects(range);
+    if (match)
+      matches.insert(std::make_pair(entry.first.start(), entry.second));
+  }
+
+  std::vector<int> values;
+  for (const auto& match : matches)
+    values.push_back(match.second);
+  return values;
+}
+
+}  // namespace
+
+TEST(IntervalTreeTest, Empty) {
+  TestIntervalTree tree;
+  EXPECT_EQ(0U, tree.size());
+
+  std::vector<int> values;
+  tree.FindIntersecting(AddressRange(0, 100), &values);
+  tree.FindSpanning(AddressRange(10, 1), &values);
+  EXPECT_TRUE(values.empty());
+  EXPECT_FALSE(tree.Remove(AddressRange(10, 1), 1));
+}
+
+TEST(IntervalTreeTest, FindIntersectingAndSpanning) {
+  TestIntervalTree tree;
+  tree.Insert(AddressRange(80, 16), 1);
+  tree.Insert(AddressRange(75, 25), 2);
+  tree.Insert(AddressRange(80, 16), 3);
+  tree.Insert(AddressRange(100, 10), 4);
+  EXPECT_EQ(4U, tree.size());
+
+  // Results come in order of address.
+  std::vector<int> values;
+  tree.FindIntersecting(AddressRange(78, 4), &values);
+  std::vector<int> expected = { 2, 1, 3 };
+  EXPECT_EQ(expected, values);
+
+  // Adjacent ranges don't intersect.
+  values.clear();
+  tree.FindIntersecting(AddressRange(110, 10), &values);
+  EXPECT_TRUE(values.empty());
+  tree.FindIntersecting(AddressRange(70, 5), &values);
+  EXPECT_TRUE(values.empty());
+
+  tree.FindSpanning(AddressRange(82, 4), &values);
+  EXPECT_EQ(expected, values);
+
+  values.clear();
+  tree.FindSpanning(AddressRange(96, 4), &values);
+  expected = { 2 };
+  EXPECT_EQ(expected, values);
+
+  values.clear();
+  tree.FindSpanning(AddressRange(95, 10), &values);
+  EXPECT_TRUE(values.empty());
+}
+
+TEST(IntervalTreeTest, Remove) {
+  TestIntervalTree tree;
+  tree.Insert(AddressRange(80, 16), 1);
+  tree.Insert(AddressRange(80, 16), 2);
+
+  // The range and the value must both match.
+  EXPECT_FALSE(tree.Remove(AddressRange(81, 16), 1));
+  EXPECT_FALSE(tree.Remove(AddressRange(80, 16), 3));
+  EXPECT_TRUE(tree.Remove(AddressRange(80, 16), 1));
+  EXPECT_FALSE(tree.Remove(AddressRange(80, 16), 1));
+  EXPECT_EQ(1U, tree.size());
+
+  std::vector<int> values;
+  tree.FindIntersecting(AddressRange(80, 1), &values);
+  std::vector<int> expected = { 2 };
+  EXPECT_EQ(expected, values);
+
+  // Removed nodes are reused.
+  tree.Insert(AddressRange(10, 1), 1);
+  EXPECT_EQ(2U, tree.size());
+
+  tree.Clear();
+  EXPECT_EQ(0U, tree.size());
+  values.clear();
+  tree.FindIntersecting(AddressRange(0, 100), &values);
+  EXPECT_TRUE(values.empty());
+}
+
+TEST(IntervalTreeTest, MatchesBruteForce) {
+  std::minstd_rand random(42);
+  TestIntervalTree tree;
+  RangeVector ranges;
+
+  for (int i = 0; i < 2000; ++i) {
+    AddressRange range(random() % 10000, 1 + random() % 200);
+    tree.Insert(range, i);
+    ranges.push_back(std::make_pair(range, i));
+
+    // Remove a random range every now and then.
+    if (i % 3 == 0) {
+      size_t index = random() % ranges.size();
+      ASSERT_TRUE(tree.Remove(ranges[index].first, ranges[index].second));
+      ranges.erase(ranges.begin() + index);
+    }
+  }
+  ASSERT_EQ(ranges.size(), tree.size());
+
+  for (int i = 0; i < 500; ++i) {
+    AddressRange range(random() % 10000, 1 + random() % 100);
+
+    std::vector<int> values;
+    tree.FindIntersecting(range, &values);
+    EXPECT_EQ(FindBruteForce(ranges, range, false), values);
+
+    values.clear();
+    tree.FindSpanning(range, &values);
+    EXPECT_EQ(FindBruteForce(ranges, range, true), values);
+  }
+}
+
+}  // namespace refinery
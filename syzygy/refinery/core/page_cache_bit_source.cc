@@ -0,0 +1,229 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "syzygy/refinery/core/page_cache_bit_source.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "base/atomicops.h"
+#include "base/logging.h"
+#include "base/threading/simple_thread.h"
+
+namespace refinery {
+
+// Reads runs of pages in parallel. Each thread claims runs one at a time, and
+// reads them into a page map of its own.
+class PageCacheBitSource::PrefetchDelegate
+    : public base::DelegateSimpleThreadPool::Delegate {
+ public:
+  // A run of pages, as its first page index and its page count.
+  typedef std::pair<Address, size_t> PageRun;
+
+  PrefetchDelegate(BitSource* bit_source, const std::vector<PageRun>& runs)
+      : bit_source_(bit_source),
+        runs_(runs),
+        pages_(runs.size()),
+        next_run_(0) {
+    DCHECK(bit_source != nullptr);
+  }
+
+  // @name base::DelegateSimpleThreadPool::Delegate implementation.
+  // @{
+  void Run() override {
+    while (true) {
+      size_t run = static_cast<size_t>(
+          base::subtle::NoBarrier_AtomicIncrement(&next_run_, 1) - 1);
+      if (run >= runs_.size())
+        return;
+      ReadPages(bit_source_, runs_[run].first, runs_[run].second,
+                &pages_[run]);
+    }
+  }
+  // @}
+
+  // Moves the pages read into @p pages.
+  void TakePages(PageMap* pages) {
+    DCHECK(pages != nullptr);
+    for (PageMap& run_pages : pages_) {
+      for (auto& page : run_pages)
+        (*pages)[page.first].swap(page.second);
+    }
+  }
+
+ private:
+  BitSource* bit_source_;
+  const std::vector<PageRun>& runs_;
+  // The pages read, by run.
+  std::vector<PageMap> pages_;
+  base::subtle::Atomic32 next_run_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrefetchDelegate);
+};
+
+PageCacheBitSource::PageCacheBitSource(BitSource* bit_source)
+    : bit_source_(bit_source) {
+  DCHECK(bit_source != nullptr);
+}
+
+PageCacheBitSource::~PageCacheBitSource() {
+}
+
+void PageCacheBitSource::Prefetch(const std::vector<AddressRange>& ranges,
+                                  size_t num_threads) {
+  DCHECK_LT(0U, num_threads);
+
+  // Gather the distinct pages that aren't cached yet.
+  std::vector<Address> pages;
+  for (const AddressRange& range : ranges) {
+    DCHECK(range.IsValid());
+    Address last_page = (range.end() - 1) / kPageSize;
+    for (Address page = range.start() / kPageSize; page <= last_page; ++page) {
+      if (pages_.find(page) == pages_.end())
+        pages.push_back(page);
+    }
+  }
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+  // Group them into runs of consecutive pages.
+  std::vector<PrefetchDelegate::PageRun> runs;
+  for (Address page : pages) {
+    if (!runs.empty() && runs.back().second < kPagesPerRead &&
+        runs.back().first + runs.back().second == page) {
+      ++runs.back().second;
+    } else {
+      runs.push_back(std::make_pair(page, 1U));
+    }
+  }
+  if (runs.empty())
+    return;
+
+  PrefetchDelegate delegate(bit_source_, runs);
+  size_t num_workers = std::min(num_threads, runs.size());
+  if (num_workers == 1) {
+    delegate.Run();
+  } else {
+    base::DelegateSimpleThreadPool pool("PageCacheBitSource",
+                                        static_cast<int>(num_workers));
+    pool.Start();
+    pool.AddWork(&delegate, static_cast<int>(num_workers));
+    pool.JoinAll();
+  }
+  delegate.TakePages(&pages_);
+}
+
+bool PageCacheBitSource::GetAll(const AddressRange& range, void* data_ptr) {
+  DCHECK(range.IsValid());
+  DCHECK(data_ptr != nullptr);
+
+  size_t data_cnt = 0;
+  return GetFrom(range, &data_cnt, data_ptr) && data_cnt == range.size();
+}
+
+bool PageCacheBitSource::GetFrom(const AddressRange& range,
+                                 size_t* data_cnt,
+                                 void* data_ptr) {
+  DCHECK(range.IsValid());
+  DCHECK(data_cnt != nullptr);
+
+  *data_cnt = 0;
+  uint8_t* dst = reinterpret_cast<uint8_t*>(data_ptr);
+  Address addr = range.start();
+  while (addr < range.end()) {
+    Address page = addr / kPageSize;
+    size_t offset = static_cast<size_t>(addr - page * kPageSize);
+    size_t wanted = static_cast<size_t>(
+        std::min(range.end(), (page + 1) * kPageSize) - addr);
+
+    const PageData& data = GetPage(page);
+    if (offset + wanted > data.size()) {
+      // The rest of the range starts past the readable head of this page, so
+      // pass it through.
+      size_t read_cnt = 0;
+      AddressRange rest(addr, static_cast<Size>(range.end() - addr));
+      if (bit_source_->GetFrom(rest, &read_cnt,
+                               dst != nullptr ? dst + *data_cnt : nullptr)) {
+        *data_cnt += read_cnt;
+      }
+      break;
+    }
+
+    if (dst != nullptr)
+      ::memcpy(dst + *data_cnt, data.data() + offset, wanted);
+    *data_cnt += wanted;
+    addr += wanted;
+  }
+
+  return *data_cnt != 0;
+}
+
+bool PageCacheBitSource::HasSome(const AddressRange& range) {
+  return bit_source_->HasSome(range);
+}
+
+void PageCacheBitSource::ReadPages(BitSource* bit_source,
+                                   Address first_page,
+                                   size_t page_count,
+                                   PageMap* pages) {
+  DCHECK(bit_source != nullptr);
+  DCHECK_LT(0U, page_count);
+  DCHECK(pages != nullptr);
+
+  std::vector<uint8_t> buffer(page_count * kPageSize);
+  size_t read_cnt = 0;
+  AddressRange range(first_page * kPageSize,
+                     static_cast<Size>(buffer.size()));
+  if (!bit_source->GetFrom(range, &read_cnt, buffer.data()))
+    read_cnt = 0;
+
+  // Split the readable head of the run into pages. The page the head ends in
+  // is cached too, so that it isn't read again.
+  for (size_t i = 0; i < page_count; ++i) {
+    size_t offset = i * kPageSize;
+    if (i != 0 && offset >= read_cnt)
+      break;
+
+    size_t size = std::min(read_cnt - std::min(read_cnt, offset),
+                           static_cast<size_t>(kPageSize));
+    (*pages)[first_page + i].assign(buffer.begin() + offset,
+                                    buffer.begin() + offset + size);
+    if (size < kPageSize)
+      break;
+  }
+}
+
+size_t PageCacheBitSource::GetUncachedRunLength(Address first_page) const {
+  size_t length = 0;
+  while (length < kPagesPerRead &&
+         pages_.find(first_page + length) == pages_.end()) {
+    ++length;
+  }
+  return length;
+}
+
+const PageCacheBitSource::PageData& PageCacheBitSource::GetPage(
+    Address page) {
+  auto it = pages_.find(page);
+  if (it != pages_.end())
+    return it->second;
+
+  ReadPages(bit_source_, page, GetUncachedRunLength(page), &pages_);
+  it = pages_.find(page);
+  DCHECK(it != pages_.end());
+  return it->second;
+}
+
+}  // namespace refinery
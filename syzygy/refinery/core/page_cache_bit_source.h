@@ -0,0 +1,109 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SYZYGY_REFINERY_CORE_PAGE_CACHE_BIT_SOURCE_H_
+#define SYZYGY_REFINERY_CORE_PAGE_CACHE_BIT_SOURCE_H_
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "syzygy/refinery/core/address.h"
+#include "syzygy/refinery/core/bit_source.h"
+
+namespace refinery {
+
+// A bit source that caches the pages of another bit source, for clients that
+// do many small reads through a bit source whose reads are expensive, such as
+// one reading another process' memory. A read that misses the cache fetches
+// a run of consecutive pages from the underlying bit source at once. Ranges
+// that are known to be walked can also be prefetched ahead of time, in
+// parallel.
+//
+// Only the readable head of each page is cached, so reads past it are passed
+// through to the underlying bit source. HasSome is always passed through.
+//
+// The contents of the underlying bit source must not change while this is in
+// use, as the cache is never invalidated. Not thread-safe.
+class PageCacheBitSource : public BitSource {
+ public:
+  // The granularity of the cache.
+  static const Size kPageSize = 4096;
+  // The maximum number of pages fetched by a single read.
+  static const size_t kPagesPerRead = 16;
+
+  // @param bit_source the bit source to cache. Must outlive this instance.
+  explicit PageCacheBitSource(BitSource* bit_source);
+  ~PageCacheBitSource() override;
+
+  // Fetches the pages of @p ranges that aren't cached yet.
+  // @param ranges the ranges to fetch.
+  // @param num_threads the number of threads to fetch with. The underlying
+  //     bit source must be safe to read concurrently if this exceeds one.
+  void Prefetch(const std::vector<AddressRange>& ranges, size_t num_threads);
+
+  // @name BitSource implementation.
+  // @{
+  bool GetAll(const AddressRange& range, void* data_ptr) override;
+  bool GetFrom(const AddressRange& range,
+               size_t* data_cnt,
+               void* data_ptr) override;
+  bool HasSome(const AddressRange& range) override;
+  // @}
+
+  // @returns the number of pages cached so far.
+  size_t cached_page_count() const { return pages_.size(); }
+
+ private:
+  // The readable head of a page, which is empty for an unreadable page.
+  typedef std::vector<uint8_t> PageData;
+  // Pages by page index.
+  typedef std::unordered_map<Address, PageData> PageMap;
+
+  class PrefetchDelegate;
+
+  // Reads a run of pages from a bit source.
+  // @param bit_source the bit source to read.
+  // @param first_page the index of the first page of the run.
+  // @param page_count the number of pages in the run.
+  // @param pages receives the pages read. The first page is always returned,
+  //     whereas pages past the readable head of the run are not.
+  static void ReadPages(BitSource* bit_source,
+                        Address first_page,
+                        size_t page_count,
+                        PageMap* pages);
+
+  // @returns the number of consecutive pages from @p first_page, up to
+  //     kPagesPerRead, that aren't cached.
+  size_t GetUncachedRunLength(Address first_page) const;
+
+  // Gets a page, reading it and the pages that follow it on a miss.
+  // @param page the index of the page.
+  // @returns the readable head of the page.
+  const PageData& GetPage(Address page);
+
+  // The bit source being cached.
+  BitSource* bit_source_;
+
+  // The pages read so far.
+  PageMap pages_;
+
+  DISALLOW_COPY_AND_ASSIGN(PageCacheBitSource);
+};
+
+}  // namespace refinery
+
+#endif  // SYZYGY_REFINERY_CORE_PAGE_CACHE_BIT_SOURCE_H_
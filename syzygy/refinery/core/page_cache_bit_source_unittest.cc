@@ -0,0 +1,188 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "syzygy/refinery/core/page_cache_bit_source.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/atomicops.h"
+#include "gtest/gtest.h"
+
+namespace refinery {
+
+namespace {
+
+// A bit source serving a pattern over a set of ranges, that counts its reads.
+// Safe to read concurrently.
+class TestBitSource : public BitSource {
+ public:
+  TestBitSource() : read_count_(0) {}
+
+  void AddRange(const AddressRange& range) { ranges_.push_back(range); }
+
+  // @returns the expected byte at @p addr.
+  static uint8_t GetByte(Address addr) {
+    return static_cast<uint8_t>(addr * 7);
+  }
+
+  bool GetAll(const AddressRange& range, void* data_ptr) override {
+    size_t data_cnt = 0;
+    return GetFrom(range, &data_cnt, data_ptr) && data_cnt == range.size();
+  }
+
+  bool GetFrom(const AddressRange& range,
+               size_t* data_cnt,
+               void* data_ptr) override {
+    base::subtle::NoBarrier_AtomicIncrement(&read_count_, 1);
+    *data_cnt = 0;
+    for (const AddressRange& available : ranges_) {
+      if (!available.Contains(range.start()))
+        continue;
+
+      Address end = std::min(range.end(), available.end());
+      *data_cnt = static_cast<size_t>(end - range.start());
+      if (data_ptr != nullptr) {
+        uint8_t* dst = reinterpret_cast<uint8_t*>(data_ptr);
+        for (Address addr = range.start(); addr < end; ++addr)
+          *dst++ = GetByte(addr);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  bool HasSome(const AddressRange& range) override {
+    for (const AddressRange& available : ranges_) {
+      if (available.Intersects(range))
+        return true;
+    }
+    return false;
+  }
+
+  int read_count() const {
+    return base::subtle::NoBarrier_Load(&read_count_);
+  }
+
+ private:
+  std::vector<AddressRange> ranges_;
+  base::subtle::Atomic32 read_count_;
+};
+
+const Size kPageSize = PageCacheBitSource::kPageSize;
+
+class PageCacheBitSourceTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // Two whole pages, a page whose head is unreadable, then a page whose
+    // head only is readable.
+    source_.AddRange(AddressRange(0x10000ULL, 2 * kPageSize));
+    source_.AddRange(AddressRange(0x12010ULL, 0x100U));
+    source_.AddRange(AddressRange(0x12200ULL, kPageSize - 0x200));
+    source_.AddRange(AddressRange(0x13000ULL, 0x80U));
+  }
+
+  TestBitSource source_;
+};
+
+}  // namespace
+
+TEST_F(PageCacheBitSourceTest, MatchesBitSource) {
+  PageCacheBitSource bit_source(&source_);
+
+  static const Size kSizes[] = { 1U, 4U, 0x100U, kPageSize + 1 };
+  for (Address addr = 0xFF80ULL; addr < 0x13100ULL; addr += 0x3F) {
+    for (Size size : kSizes) {
+      AddressRange range(addr, size);
+
+      std::vector<uint8_t> expected(size, 0xCC);
+      std::vector<uint8_t> actual(size, 0xCC);
+      bool expected_ok = source_.GetAll(range, expected.data());
+      EXPECT_EQ(expected_ok, bit_source.GetAll(range, actual.data()));
+      EXPECT_EQ(expected, actual);
+
+      size_t expected_cnt = 0U;
+      size_t actual_cnt = 0U;
+      expected_ok = source_.GetFrom(range, &expected_cnt, expected.data());
+      EXPECT_EQ(expected_ok,
+                bit_source.GetFrom(range, &actual_cnt, actual.data()));
+      if (expected_ok) {
+        EXPECT_EQ(expected_cnt, actual_cnt);
+        EXPECT_EQ(expected, actual);
+      }
+
+      EXPECT_EQ(source_.HasSome(range), bit_source.HasSome(range));
+    }
+  }
+}
+
+TEST_F(PageCacheBitSourceTest, ReadsRunsOfPages) {
+  PageCacheBitSource bit_source(&source_);
+
+  // The first read fetches both readable pages at once.
+  uint8_t value = 0;
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x10000ULL, 1U), &value));
+  EXPECT_EQ(TestBitSource::GetByte(0x10000ULL), value);
+  EXPECT_EQ(1, source_.read_count());
+  EXPECT_EQ(2U, bit_source.cached_page_count());
+
+  // Reads within, and across, the cached pages don't go to the bit source.
+  uint32_t word = 0;
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x10FFEULL, 4U), &word));
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x11FFCULL, 4U), &word));
+  EXPECT_EQ(1, source_.read_count());
+
+  // Reads past the readable head of a page are passed through.
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x12010ULL, 4U), &word));
+  EXPECT_EQ(3, source_.read_count());
+  EXPECT_EQ(3U, bit_source.cached_page_count());
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x12010ULL, 4U), &word));
+  EXPECT_EQ(4, source_.read_count());
+
+  // The readable head of a page is cached.
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x13000ULL, 4U), &word));
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x1307CULL, 4U), &word));
+  EXPECT_EQ(5, source_.read_count());
+  EXPECT_FALSE(bit_source.GetAll(AddressRange(0x1307EULL, 4U), &word));
+  EXPECT_EQ(6, source_.read_count());
+  EXPECT_EQ(4U, bit_source.cached_page_count());
+}
+
+TEST_F(PageCacheBitSourceTest, Prefetch) {
+  std::vector<AddressRange> ranges;
+  ranges.push_back(AddressRange(0x10000ULL, 2 * kPageSize));
+  ranges.push_back(AddressRange(0x10800ULL, 0x10U));
+  ranges.push_back(AddressRange(0x13000ULL, 0x80U));
+
+  PageCacheBitSource bit_source(&source_);
+  bit_source.Prefetch(ranges, 4U);
+  EXPECT_EQ(3U, bit_source.cached_page_count());
+  int read_count = source_.read_count();
+
+  // Reads in the prefetched ranges don't go to the bit source.
+  std::vector<uint8_t> data(2 * kPageSize);
+  EXPECT_TRUE(
+      bit_source.GetAll(AddressRange(0x10000ULL, 2 * kPageSize), data.data()));
+  for (size_t i = 0; i < data.size(); ++i)
+    ASSERT_EQ(TestBitSource::GetByte(0x10000ULL + i), data[i]);
+  EXPECT_TRUE(bit_source.GetAll(AddressRange(0x13000ULL, 0x80U), data.data()));
+  EXPECT_EQ(read_count, source_.read_count());
+
+  // Prefetching cached pages is a no-op.
+  bit_source.Prefetch(ranges, 4U);
+  EXPECT_EQ(read_count, source_.read_count());
+}
+
+}  // namespace refinery
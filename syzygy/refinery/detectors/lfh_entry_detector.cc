@@ -14,6 +14,10 @@
 
 #include "syzygy/refinery/detectors/lfh_entry_detector.h"
 
+#include <string.h>
+#include <algorithm>
+#include <utility>
+
 #include "base/logging.h"
 #include "base/containers/hash_tables.h"
 #include "syzygy/common/align.h"
@@ -21,7 +25,20 @@
 
 namespace refinery {
 
-LFHEntryDetector::LFHEntryDetector() : bit_source_(nullptr) {
+namespace {
+
+// Reads the little-endian value of @p size bytes at @p data.
+uint64_t ReadValue(const uint8_t* data, size_t size) {
+  uint64_t value = 0;
+  DCHECK_LE(size, sizeof(value));
+  ::memcpy(&value, data, size);
+  return value;
+}
+
+}  // namespace
+
+LFHEntryDetector::LFHEntryDetector()
+    : bit_source_(nullptr), has_field_layouts_(false) {
 }
 
 bool LFHEntryDetector::Init(TypeRepository* repo, BitSource* bit_source) {
@@ -41,6 +58,10 @@ bool LFHEntryDetector::Init(TypeRepository* repo, BitSource* bit_source) {
     return false;
 
   bit_source_ = bit_source;
+  has_field_layouts_ =
+      GetFieldLayout(L"SubSegmentCode", &subsegment_code_field_) &&
+      GetFieldLayout(L"ExtendedBlockSignature",
+                     &extended_block_signature_field_);
 
   return true;
 }
@@ -62,12 +83,16 @@ bool LFHEntryDetector::Detect(const AddressRange& range,
       common::AlignDown(range.end() - entry_type_->size(), kEntrySize);
   DCHECK_EQ(0, (end - start) % kEntrySize);
 
-  // TODO(siggi): This is ~O(N^2) and so is wasteful for large ranges.
-  //     A better approach might be to process the entire range, count up all
-  //     the subsegment codes that occur, with the first occurrence of each.
-  //     This will then allow processing the range in closer to O(N), as a
-  //     search will only be done where a code occurs more than once, and then
-  //     from the first occurrence of that code.
+  // Decode the whole range at once when possible. Otherwise, fall back to
+  // scanning from each entry, which is ~O(N^2).
+  if (has_field_layouts_ && start < end) {
+    std::vector<uint8_t> data(end - start);
+    if (bit_source_->GetAll(AddressRange(start, data.size()), &data.at(0))) {
+      DetectInData(start, data, found_runs);
+      return true;
+    }
+  }
+
   SubsegmentSet used_subsegments;
   for (Address curr = start; curr < end; curr += kEntrySize) {
     LFHEntryRun found_run;
@@ -136,20 +161,9 @@ bool LFHEntryDetector::ScanForEntryMatch(const AddressRange& range,
     return false;
   }
 
-  // Check that the LFH flag is set on the entry.
-  const uint16_t kLFHBlockFlag = 0x80;
-  if ((extended_block_signature & kLFHBlockFlag) == 0)
+  if (!IsLFHEntrySignature(extended_block_signature))
     return false;
 
-  // Check that the rest of the entry is sane. Free blocks have the remaining
-  // bits set, whereas used blocks use the remaining bits to encode the number
-  // of unused bytes in the block, plus 8.
-  const uint16_t kLFHUnusedBytesMask = 0x7F;
-  if ((extended_block_signature & kLFHUnusedBytesMask) != 0 &&
-      (extended_block_signature & kLFHUnusedBytesMask) < 8) {
-    return false;
-  }
-
   // Now that the entry has passed initial validation, record that we're
   // processing this subsegment value.
   used_subsegments->insert(subseg);
@@ -157,7 +171,6 @@ bool LFHEntryDetector::ScanForEntryMatch(const AddressRange& range,
   // The distance histogram is used to pick an entry size by simple majority
   // vote. This yields some resilience to corruption and false positive
   // matches.
-  using DistanceHistogram = std::unordered_map<size_t, size_t>;
   DistanceHistogram distances;
   Address last_match = range.start();
 
@@ -187,6 +200,129 @@ bool LFHEntryDetector::ScanForEntryMatch(const AddressRange& range,
   if (distances.size() == 0)
     return false;
 
+  RecordRun(range.start(), last_match, subseg, distances, found_run);
+  return true;
+}
+
+bool LFHEntryDetector::GetFieldLayout(const base::StringPiece16& name,
+                                      FieldLayout* layout) const {
+  DCHECK(layout);
+  DCHECK(entry_type_);
+
+  for (const auto& field : entry_type_->fields()) {
+    MemberFieldPtr member;
+    if (!field->CastTo(&member) || name != member->name())
+      continue;
+
+    size_t size = member->GetType()->size();
+    if (member->bit_len() != 0 ||
+        (size != 1 && size != 2 && size != 4 && size != 8) ||
+        member->offset() < 0 ||
+        member->offset() + size > entry_type_->size()) {
+      return false;
+    }
+
+    layout->offset = member->offset();
+    layout->size = size;
+    return true;
+  }
+
+  return false;
+}
+
+void LFHEntryDetector::DetectInData(Address start,
+                                    const std::vector<uint8_t>& data,
+                                    LFHEntryRuns* found_runs) const {
+  DCHECK(found_runs);
+  DCHECK(has_field_layouts_);
+
+  const size_t kEntrySize = entry_type_->size();
+  const size_t entry_count = data.size() / kEntrySize;
+
+  // Decode the subsegment code of each entry, then sort the entries by code
+  // so that the entries sharing a code are adjacent, in address order.
+  std::vector<uint64_t> subsegs(entry_count);
+  std::vector<std::pair<uint64_t, size_t>> sorted_entries(entry_count);
+  for (size_t i = 0; i < entry_count; ++i) {
+    const uint8_t* entry_data = &data[i * kEntrySize];
+    const Address entry = start + i * kEntrySize;
+    subsegs[i] = ReadValue(entry_data + subsegment_code_field_.offset,
+                           subsegment_code_field_.size) ^
+                 (entry >> 3);
+    sorted_entries[i] = std::make_pair(subsegs[i], i);
+  }
+  std::sort(sorted_entries.begin(), sorted_entries.end());
+
+  // The position of each entry in sorted_entries.
+  std::vector<size_t> sorted_positions(entry_count);
+  for (size_t i = 0; i < entry_count; ++i)
+    sorted_positions[sorted_entries[i].second] = i;
+
+  // Scan from each entry as ScanForEntryMatch does, but only visit the
+  // following entries with the same code.
+  base::hash_set<uint64_t> used_subsegments;
+  for (size_t i = 0; i < entry_count; ++i) {
+    const uint64_t subseg = subsegs[i];
+    if (used_subsegments.find(subseg) != used_subsegments.end())
+      continue;
+
+    uint64_t extended_block_signature = ReadValue(
+        &data[i * kEntrySize + extended_block_signature_field_.offset],
+        extended_block_signature_field_.size);
+    if (!IsLFHEntrySignature(extended_block_signature))
+      continue;
+    used_subsegments.insert(subseg);
+
+    DistanceHistogram distances;
+    Address last_match = start + i * kEntrySize;
+    for (size_t j = sorted_positions[i] + 1;
+         j < entry_count && sorted_entries[j].first == subseg; ++j) {
+      // As in ScanForEntryMatch, the search starts two entries further.
+      const size_t candidate = sorted_entries[j].second;
+      if (candidate < i + 2)
+        continue;
+
+      const Address candidate_addr = start + candidate * kEntrySize;
+      ++distances[candidate_addr - last_match];
+      last_match = candidate_addr;
+    }
+
+    if (distances.size() == 0)
+      continue;
+
+    LFHEntryRun found_run = {};
+    RecordRun(start + i * kEntrySize, last_match, subseg, distances,
+              &found_run);
+    found_runs->push_back(found_run);
+  }
+}
+
+bool LFHEntryDetector::IsLFHEntrySignature(uint64_t extended_block_signature) {
+  // Check that the LFH flag is set on the entry.
+  const uint16_t kLFHBlockFlag = 0x80;
+  if ((extended_block_signature & kLFHBlockFlag) == 0)
+    return false;
+
+  // Check that the rest of the entry is sane. Free blocks have the remaining
+  // bits set, whereas used blocks use the remaining bits to encode the number
+  // of unused bytes in the block, plus 8.
+  const uint16_t kLFHUnusedBytesMask = 0x7F;
+  if ((extended_block_signature & kLFHUnusedBytesMask) != 0 &&
+      (extended_block_signature & kLFHUnusedBytesMask) < 8) {
+    return false;
+  }
+
+  return true;
+}
+
+void LFHEntryDetector::RecordRun(Address first_entry,
+                                 Address last_entry,
+                                 uint64_t subsegment_code,
+                                 const DistanceHistogram& distances,
+                                 LFHEntryRun* found_run) {
+  DCHECK(!distances.empty());
+  DCHECK(found_run);
+
   size_t voted_size = 0;
   size_t voted_count = 0;
   size_t num_votes = 0;
@@ -203,14 +339,12 @@ bool LFHEntryDetector::ScanForEntryMatch(const AddressRange& range,
   }
 
   // Record the found run.
-  found_run->first_entry = range.start();
-  found_run->last_entry = last_match;
+  found_run->first_entry = first_entry;
+  found_run->last_entry = last_entry;
   found_run->entry_distance_bytes = voted_size;
   found_run->size_votes = voted_count;
   found_run->entries_found = num_votes + 1;
-  found_run->subsegment_code = subseg;
-
-  return true;
+  found_run->subsegment_code = subsegment_code;
 }
 
 }  // namespace refinery
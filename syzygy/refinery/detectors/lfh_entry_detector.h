@@ -16,9 +16,11 @@
 #define SYZYGY_REFINERY_DETECTORS_LFH_ENTRY_DETECTOR_H_
 
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include "base/macros.h"
+#include "base/strings/string_piece.h"
 
 #include "syzygy/refinery/types/type.h"
 #include "syzygy/refinery/types/type_repository.h"
@@ -104,6 +106,43 @@ class LFHEntryDetector {
 
  private:
   typedef std::set<uint64_t> SubsegmentSet;
+  // Maps the distances between matching entries to their number.
+  typedef std::unordered_map<size_t, size_t> DistanceHistogram;
+
+  // The location of a field of the heap entry type, for direct decoding.
+  struct FieldLayout {
+    size_t offset;
+    size_t size;
+  };
+
+  // Locates the field @p name of entry_type_.
+  // @param name the name of the field.
+  // @param layout on success, the location of the field.
+  // @returns true if the field is a plain field of 1, 2, 4 or 8 bytes.
+  bool GetFieldLayout(const base::StringPiece16& name,
+                      FieldLayout* layout) const;
+
+  // Detects the entry runs of the entry-aligned range starting at @p start
+  // whose bytes are @p data. This yields the same runs as ScanForEntryMatch
+  // at each entry, but decodes each entry once and only compares entries
+  // with equal subsegment codes.
+  // @param start the address of the range.
+  // @param data the bytes of the range.
+  // @param found_runs receives the heap entry runs detected.
+  void DetectInData(Address start,
+                    const std::vector<uint8_t>& data,
+                    LFHEntryRuns* found_runs) const;
+
+  // @returns true if @p extended_block_signature is that of an LFH entry.
+  static bool IsLFHEntrySignature(uint64_t extended_block_signature);
+
+  // Records a run from @p first_entry to @p last_entry with the distance
+  // picked by majority vote among @p distances.
+  static void RecordRun(Address first_entry,
+                        Address last_entry,
+                        uint64_t subsegment_code,
+                        const DistanceHistogram& distances,
+                        LFHEntryRun* found_run);
 
   // Scans forward through @p range for a run of entries starting at
   // @p range.start().
@@ -119,6 +158,11 @@ class LFHEntryDetector {
   // Valid from Init().
   BitSource* bit_source_;
   UserDefinedTypePtr entry_type_;
+  // Whether the fields below could be located, which allows decoding
+  // entries directly from their bytes.
+  bool has_field_layouts_;
+  FieldLayout subsegment_code_field_;
+  FieldLayout extended_block_signature_field_;
 
   DISALLOW_COPY_AND_ASSIGN(LFHEntryDetector);
 };
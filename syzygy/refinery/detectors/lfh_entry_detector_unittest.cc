@@ -24,6 +24,17 @@ namespace refinery {
 
 namespace {
 
+// A bit source that only serves reads of up to one 64 bit heap entry, which
+// forces the detector to scan from each entry.
+class SmallReadBitSource : public testing::SelfBitSource {
+ public:
+  bool GetAll(const AddressRange& range, void* data_ptr) override {
+    if (range.size() > 16)
+      return false;
+    return SelfBitSource::GetAll(range, data_ptr);
+  }
+};
+
 class LFHEntryDetectorTest : public testing::LFHDetectorTest {
  protected:
   // TODO(siggi): This code is 32 bit heap specific - amend this for 64 bit
@@ -42,10 +53,15 @@ class LFHEntryDetectorTest : public testing::LFHDetectorTest {
   }
 
   void DetectTestData(LFHEntryDetector::LFHEntryRuns* found_runs) {
+    DetectTestData(bit_source(), found_runs);
+  }
+
+  void DetectTestData(BitSource* bit_source,
+                      LFHEntryDetector::LFHEntryRuns* found_runs) {
     ASSERT_TRUE(found_runs);
 
     LFHEntryDetector detector;
-    ASSERT_TRUE(detector.Init(repo().get(), bit_source()));
+    ASSERT_TRUE(detector.Init(repo().get(), bit_source));
     ASSERT_TRUE(detector.Detect(
         AddressRange(testing::ToAddress(&test_data_.at(0)), test_data_.size()),
         found_runs));
@@ -155,4 +171,38 @@ TEST_F(LFHEntryDetectorTest, VotingPicksMinimumDistance) {
   EXPECT_EQ(16, found_runs[0].entry_distance_bytes);
 }
 
+TEST_F(LFHEntryDetectorTest, RangeScanMatchesEntryScan) {
+  ResetTestData(4096);
+
+  // Interleave runs of several codes, with corrupt and stray entries.
+  const uintptr_t kSubsegCodes[] = { 0xCAFEBABE, 0xDEADBEEF, 0x12345678 };
+  for (size_t i = 0; i < 40; ++i) {
+    if (i % 7 == 3)
+      continue;
+    WriteSubseg(24 * i + 8, kSubsegCodes[0]);
+    WriteSubseg(48 * i + 16, kSubsegCodes[1]);
+  }
+  WriteSubseg(8 * 301, kSubsegCodes[2]);
+  WriteSubseg(8 * 400, kSubsegCodes[2]);
+
+  LFHEntryDetector::LFHEntryRuns range_runs;
+  ASSERT_NO_FATAL_FAILURE(DetectTestData(&range_runs));
+  SmallReadBitSource small_read_bit_source;
+  LFHEntryDetector::LFHEntryRuns entry_runs;
+  ASSERT_NO_FATAL_FAILURE(
+      DetectTestData(&small_read_bit_source, &entry_runs));
+
+  ASSERT_LE(3U, range_runs.size());
+  ASSERT_EQ(entry_runs.size(), range_runs.size());
+  for (size_t i = 0; i < range_runs.size(); ++i) {
+    EXPECT_EQ(entry_runs[i].first_entry, range_runs[i].first_entry);
+    EXPECT_EQ(entry_runs[i].last_entry, range_runs[i].last_entry);
+    EXPECT_EQ(entry_runs[i].entry_distance_bytes,
+              range_runs[i].entry_distance_bytes);
+    EXPECT_EQ(entry_runs[i].size_votes, range_runs[i].size_votes);
+    EXPECT_EQ(entry_runs[i].entries_found, range_runs[i].entries_found);
+    EXPECT_EQ(entry_runs[i].subsegment_code, range_runs[i].subsegment_code);
+  }
+}
+
 }  // namespace refinery
@@ -0,0 +1,147 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/refinery/process_state/caching_bit_source.h"
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+#include "base/logging.h"
+
+namespace refinery {
+
+CachingBitSource::CachingBitSource(ProcessState* process_state)
+    : process_state_(process_state),
+      looked_up_bytes_layer_(false),
+      has_last_record_(false) {
+  DCHECK(process_state != nullptr);
+}
+
+CachingBitSource::~CachingBitSource() {
+}
+
+const uint8_t* CachingBitSource::GetPointer(const AddressRange& range) {
+  DCHECK(range.IsValid());
+
+  const CachedRecord* record = FindSpanningRecord(range);
+  if (record == nullptr)
+    return nullptr;
+
+  return record->data + (range.start() - record->range.start());
+}
+
+bool CachingBitSource::GetAll(const AddressRange& range, void* data_ptr) {
+  DCHECK(range.IsValid());
+  DCHECK(data_ptr != nullptr);
+
+  const uint8_t* data = GetPointer(range);
+  if (data == nullptr)
+    return false;
+
+  ::memcpy(data_ptr, data, range.size());
+  return true;
+}
+
+bool CachingBitSource::GetFrom(const AddressRange& range,
+                               size_t* data_cnt,
+                               void* data_ptr) {
+  DCHECK(range.IsValid());
+  DCHECK(data_cnt != nullptr);
+
+  // Find the record that contains the head of the range.
+  const CachedRecord* record = FindRecord(range.start());
+  if (record == nullptr)
+    return false;
+
+  // Determine the range that can be served.
+  Address available_end = std::min(range.end(), record->range.end());
+  *data_cnt = static_cast<size_t>(available_end - range.start());
+  if (data_ptr == nullptr)
+    return true;  // Actual bytes not requested.
+
+  ::memcpy(data_ptr, record->data + (range.start() - record->range.start()),
+           *data_cnt);
+  return true;
+}
+
+bool CachingBitSource::HasSome(const AddressRange& range) {
+  DCHECK(range.IsValid());
+
+  // The range may cover many pages, so it's not worth caching.
+  LookUpBytesLayer();
+  if (bytes_layer_ == nullptr)
+    return false;
+
+  std::vector<BytesRecordPtr> matching_records;
+  bytes_layer_->GetRecordsIntersecting(range, &matching_records);
+  return !matching_records.empty();
+}
+
+void CachingBitSource::LookUpBytesLayer() {
+  if (looked_up_bytes_layer_)
+    return;
+
+  process_state_->FindLayer(&bytes_layer_);
+  looked_up_bytes_layer_ = true;
+}
+
+const CachingBitSource::CachedRecords& CachingBitSource::GetPageRecords(
+    Address page) {
+  auto it = pages_.find(page);
+  if (it != pages_.end())
+    return it->second;
+
+  LookUpBytesLayer();
+
+  CachedRecords& records = pages_[page];
+  if (bytes_layer_ == nullptr)
+    return records;
+
+  std::vector<BytesRecordPtr> matching_records;
+  bytes_layer_->GetRecordsIntersecting(
+      AddressRange(page * kPageSize, kPageSize), &matching_records);
+  records.reserve(matching_records.size());
+  for (const BytesRecordPtr& bytes_record : matching_records) {
+    const std::string& data = bytes_record->data().data();
+    // A record whose data is shorter than its range can't serve reads.
+    if (data.size() < bytes_record->range().size())
+      continue;
+
+    CachedRecord record = {bytes_record->range(),
+                           reinterpret_cast<const uint8_t*>(data.data())};
+    records.push_back(record);
+  }
+
+  return records;
+}
+
+const CachingBitSource::CachedRecord* CachingBitSource::FindSpanningRecord(
+    const AddressRange& range) {
+  if (has_last_record_ && last_record_.range.Contains(range))
+    return &last_record_;
+
+  // A record spanning the range intersects the page of its start.
+  for (const CachedRecord& record : GetPageRecords(range.start() / kPageSize)) {
+    if (record.range.Contains(range)) {
+      last_record_ = record;
+      has_last_record_ = true;
+      return &last_record_;
+    }
+  }
+
+  return nullptr;
+}
+
+}  // namespace refinery
@@ -0,0 +1,118 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SYZYGY_REFINERY_PROCESS_STATE_CACHING_BIT_SOURCE_H_
+#define SYZYGY_REFINERY_PROCESS_STATE_CACHING_BIT_SOURCE_H_
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "syzygy/refinery/core/address.h"
+#include "syzygy/refinery/core/bit_source.h"
+#include "syzygy/refinery/process_state/process_state.h"
+
+namespace refinery {
+
+// A bit source over the bytes layer of a process state, for clients that do
+// many small reads, such as TypedData traversals. Each page of the address
+// space the first read lands on is looked up once in the bytes layer, and the
+// bytes records intersecting it are remembered, so that subsequent reads are
+// served without querying the layer. Reads falling in the same record as the
+// previous read don't even look up the page. HasSome queries the layer
+// directly, as its range may cover many pages.
+//
+// The bytes layer must not change while the bit source is in use, as the
+// cache is never invalidated. Not thread-safe.
+class CachingBitSource : public BitSource {
+ public:
+  // The granularity of the cache.
+  static const Size kPageSize = 4096;
+
+  // @param process_state the process state whose bytes layer to read. Must
+  //     outlive this instance.
+  explicit CachingBitSource(ProcessState* process_state);
+  ~CachingBitSource() override;
+
+  // Gets a pointer to the bytes of a range, without copying.
+  // @pre @p range must be a valid range.
+  // @param range the requested range.
+  // @returns a pointer to the contents of @p range, or nullptr if a single
+  //     bytes record doesn't span @p range. The pointer is valid for as long
+  //     as the bytes layer is unchanged.
+  const uint8_t* GetPointer(const AddressRange& range);
+
+  // @name BitSource implementation.
+  // @{
+  bool GetAll(const AddressRange& range, void* data_ptr) override;
+  bool GetFrom(const AddressRange& range,
+               size_t* data_cnt,
+               void* data_ptr) override;
+  bool HasSome(const AddressRange& range) override;
+  // @}
+
+  // @returns the number of pages cached so far.
+  size_t cached_page_count() const { return pages_.size(); }
+
+ private:
+  // A bytes record, with its data resolved.
+  struct CachedRecord {
+    AddressRange range;
+    const uint8_t* data;
+  };
+  typedef std::vector<CachedRecord> CachedRecords;
+
+  // Looks up bytes_layer_ in the process state, on the first call.
+  void LookUpBytesLayer();
+
+  // Gets the records intersecting a page, looking them up in the bytes layer
+  // on the first request.
+  // @param page the index of the page.
+  // @returns the records intersecting the page, in increasing order of
+  //     address.
+  const CachedRecords& GetPageRecords(Address page);
+
+  // Finds a record spanning a range.
+  // @param range the range to span.
+  // @returns the first record spanning @p range, or nullptr if there is none.
+  const CachedRecord* FindSpanningRecord(const AddressRange& range);
+
+  // Finds a record containing an address.
+  // @param addr the address to contain.
+  // @returns the first record containing @p addr, or nullptr if there is none.
+  const CachedRecord* FindRecord(Address addr) {
+    return FindSpanningRecord(AddressRange(addr, 1U));
+  }
+
+  ProcessState* process_state_;
+
+  // The bytes layer, which is looked up on first use. Holding a reference to
+  // it keeps the records' data alive.
+  bool looked_up_bytes_layer_;
+  BytesLayerPtr bytes_layer_;
+
+  // The records intersecting each page looked up so far, by page index.
+  std::unordered_map<Address, CachedRecords> pages_;
+
+  // The record that served the last read, for runs of reads in one record.
+  CachedRecord last_record_;
+  bool has_last_record_;
+
+  DISALLOW_COPY_AND_ASSIGN(CachingBitSource);
+};
+
+}  // namespace refinery
+
+#endif  // SYZYGY_REFINERY_PROCESS_STATE_CACHING_BIT_SOURCE_H_
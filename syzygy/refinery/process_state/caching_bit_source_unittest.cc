@@ -0,0 +1,122 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/refinery/process_state/caching_bit_source.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "syzygy/refinery/process_state/refinery.pb.h"
+
+namespace refinery {
+
+namespace {
+
+class CachingBitSourceTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // A record straddling a page boundary, then a hole, then a small record.
+    AddBytesRecord(0x1F00ULL, 0x300U);
+    AddBytesRecord(0x2400ULL, 0x10U);
+  }
+
+  // Adds a bytes record to process_state_, filled with a pattern.
+  // @param address the address of the record.
+  // @param size the size of the record.
+  void AddBytesRecord(Address address, Size size) {
+    BytesLayerPtr bytes_layer;
+    process_state_.FindOrCreateLayer(&bytes_layer);
+    BytesRecordPtr bytes_record;
+    bytes_layer->CreateRecord(AddressRange(address, size), &bytes_record);
+
+    std::string* data = bytes_record->mutable_data()->mutable_data();
+    for (Size i = 0; i < size; ++i)
+      data->push_back(static_cast<char>((address + i) * 7));
+  }
+
+  ProcessState process_state_;
+};
+
+}  // namespace
+
+TEST_F(CachingBitSourceTest, MatchesProcessState) {
+  CachingBitSource bit_source(&process_state_);
+
+  static const Size kSizes[] = { 1U, 4U, 8U, 0x100U };
+  for (Address addr = 0x1E80ULL; addr < 0x2480ULL; addr += 0x1F) {
+    for (Size size : kSizes) {
+      AddressRange range(addr, size);
+
+      std::vector<char> expected(size, '-');
+      std::vector<char> actual(size, '-');
+      bool expected_ok = process_state_.GetAll(range, expected.data());
+      EXPECT_EQ(expected_ok, bit_source.GetAll(range, actual.data()));
+      EXPECT_EQ(expected, actual);
+      EXPECT_EQ(expected_ok, bit_source.GetPointer(range) != nullptr);
+
+      size_t expected_cnt = 0U;
+      size_t actual_cnt = 0U;
+      expected_ok =
+          process_state_.GetFrom(range, &expected_cnt, expected.data());
+      EXPECT_EQ(expected_ok,
+                bit_source.GetFrom(range, &actual_cnt, actual.data()));
+      if (expected_ok) {
+        EXPECT_EQ(expected_cnt, actual_cnt);
+        EXPECT_EQ(expected, actual);
+      }
+    }
+  }
+
+  // Only the pages that were read were cached.
+  EXPECT_EQ(2U, bit_source.cached_page_count());
+}
+
+TEST_F(CachingBitSourceTest, GetPointer) {
+  CachingBitSource bit_source(&process_state_);
+
+  BytesRecordPtr record;
+  ASSERT_TRUE(process_state_.FindSingleRecord(0x2400ULL, &record));
+  const uint8_t* expected =
+      reinterpret_cast<const uint8_t*>(record->data().data().data());
+
+  EXPECT_EQ(expected, bit_source.GetPointer(AddressRange(0x2400ULL, 0x10U)));
+  EXPECT_EQ(expected + 4, bit_source.GetPointer(AddressRange(0x2404ULL, 4U)));
+  EXPECT_EQ(nullptr, bit_source.GetPointer(AddressRange(0x2404ULL, 0x10U)));
+  EXPECT_EQ(nullptr, bit_source.GetPointer(AddressRange(0x2300ULL, 4U)));
+}
+
+TEST_F(CachingBitSourceTest, HasSome) {
+  CachingBitSource bit_source(&process_state_);
+
+  EXPECT_TRUE(bit_source.HasSome(AddressRange(0x1000ULL, 0x1000U)));
+  EXPECT_TRUE(bit_source.HasSome(AddressRange(0x23F0ULL, 0x11U)));
+  EXPECT_FALSE(bit_source.HasSome(AddressRange(0x2200ULL, 0x200U)));
+  EXPECT_FALSE(bit_source.HasSome(AddressRange(0x2410ULL, 0x100U)));
+}
+
+TEST(CachingBitSourceNoBytesTest, EmptyProcessState) {
+  ProcessState process_state;
+  CachingBitSource bit_source(&process_state);
+
+  char buffer = '-';
+  size_t data_cnt = 0U;
+  EXPECT_FALSE(bit_source.GetAll(AddressRange(0x1000ULL, 1U), &buffer));
+  EXPECT_FALSE(
+      bit_source.GetFrom(AddressRange(0x1000ULL, 1U), &data_cnt, &buffer));
+  EXPECT_FALSE(bit_source.HasSome(AddressRange(0x1000ULL, 1U)));
+  EXPECT_EQ(nullptr, bit_source.GetPointer(AddressRange(0x1000ULL, 1U)));
+}
+
+}  // namespace refinery
@@ -63,6 +63,8 @@
       'target_name': 'process_state_lib',
       'type': 'static_library',
       'sources': [
+        'caching_bit_source.cc',
+        'caching_bit_source.h',
         'layer_data.cc',
         'layer_data.h',
         'layer_traits.h',
@@ -22,8 +22,10 @@
 #include "base/logging.h"
 #include "base/macros.h"
 #include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
 #include "syzygy/refinery/core/address.h"
 #include "syzygy/refinery/core/bit_source.h"
+#include "syzygy/refinery/core/interval_tree.h"
 #include "syzygy/refinery/process_state/layer_traits.h"
 #include "syzygy/refinery/process_state/record_traits.h"
 #include "syzygy/refinery/process_state/refinery.pb.h"
@@ -129,10 +131,14 @@ class ProcessState : public BitSource {
  private:
   class LayerBase;
 
+  // @pre layers_lock_ must be held.
   template<typename RecordType>
   void CreateLayer(scoped_refptr<Layer<RecordType>>* layer);
 
-  std::map<RecordId, scoped_refptr<LayerBase>> layers_;
+  // Guards layers_, so that analyzers running concurrently can find and create
+  // layers. The layers themselves aren't guarded.
+  base::Lock layers_lock_;
+  std::map<RecordId, scoped_refptr<LayerBase>> layers_;  // Under layers_lock_.
 
   bool has_exception;
   size_t excepting_thread_id;
@@ -198,14 +204,14 @@ class ProcessState::Layer : public ProcessState::LayerBase {
   // @param records contains the matching records.
   void GetRecordsAt(Address addr, std::vector<RecordPtr>* records) const;
 
-  // Gets records that fully span |range|.
+  // Gets records that fully span |range|, in increasing order of address.
   // @pre @p range must be a valid.
   // @param range the address range the region records should span.
   // @param records contains the matching records.
   void GetRecordsSpanning(const AddressRange& range,
                           std::vector<RecordPtr>* records) const;
 
-  // Gets records that intersect |range|.
+  // Gets records that intersect |range|, in increasing order of address.
   // @pre @p range must be a valid.
   // @param range the address range the region records should intersect.
   // @param records contains the matching records.
@@ -228,7 +234,10 @@ class ProcessState::Layer : public ProcessState::LayerBase {
 
  private:
   typename LayerTraits<RecordType>::DataType data_;
+  // The records, which this holds a reference to, by address.
   std::multimap<Address, RecordPtr> records_;
+  // An index of records_ by range, for the spanning and intersecting queries.
+  IntervalTree<Record<RecordType>*> record_index_;
 };
 
 #define DECL_LAYER_TYPES(layer_name)                                           \
@@ -277,6 +286,7 @@ template<typename RecordType>
 bool ProcessState::FindLayer(scoped_refptr<Layer<RecordType>>* layer) {
   DCHECK(layer != nullptr);
 
+  base::AutoLock auto_lock(layers_lock_);
   RecordId id = RecordTraits<RecordType>::ID;
   auto it = layers_.find(id);
   if (it != layers_.end()) {
@@ -292,8 +302,13 @@ void ProcessState::FindOrCreateLayer(
     scoped_refptr<Layer<RecordType>>* layer) {
   DCHECK(layer != nullptr);
 
-  if (FindLayer(layer))
+  base::AutoLock auto_lock(layers_lock_);
+  RecordId id = RecordTraits<RecordType>::ID;
+  auto it = layers_.find(id);
+  if (it != layers_.end()) {
+    *layer = static_cast<Layer<RecordType>*>(it->second.get());
     return;
+  }
 
   CreateLayer(layer);
 }
@@ -319,6 +334,7 @@ bool ProcessState::FindSingleRecord(Address addr,
 template<typename RecordType>
 void ProcessState::CreateLayer(scoped_refptr<Layer<RecordType>>* layer) {
   DCHECK(layer != nullptr);
+  layers_lock_.AssertAcquired();
 
   scoped_refptr<Layer<RecordType>> new_layer = new Layer<RecordType>();
   DCHECK(new_layer.get() != nullptr);
@@ -340,6 +356,7 @@ void ProcessState::Layer<RecordType>::CreateRecord(
 
   RecordPtr new_record = new Record<RecordType>(range);
   records_.insert(std::make_pair(range.start(), new_record));
+  record_index_.Insert(range, new_record.get());
 
   record->swap(new_record);
 }
@@ -365,16 +382,9 @@ void ProcessState::Layer<RecordType>::GetRecordsSpanning(
 
   records->clear();
 
-  for (const auto& entry : records_) {
-    AddressRange record_range = entry.second->range();
-    DCHECK(record_range.IsValid());
-    if (record_range.Contains(range))
-      records->push_back(entry.second);
-
-    if (record_range.start() > range.start())
-      // Records that start after the range, or any after, cannot span it.
-      return;
-  }
+  std::vector<Record<RecordType>*> matches;
+  record_index_.FindSpanning(range, &matches);
+  records->assign(matches.begin(), matches.end());
 }
 
 template <typename RecordType>
@@ -385,12 +395,9 @@ void ProcessState::Layer<RecordType>::GetRecordsIntersecting(
 
   records->clear();
 
-  for (const auto& entry : records_) {
-    AddressRange record_range = entry.second->range();
-    DCHECK(record_range.IsValid());
-    if (record_range.Intersects(range))
-      records->push_back(entry.second);
-  }
+  std::vector<Record<RecordType>*> matches;
+  record_index_.FindIntersecting(range, &matches);
+  records->assign(matches.begin(), matches.end());
 }
 
 template <typename RecordType>
@@ -402,6 +409,8 @@ bool ProcessState::Layer<RecordType>::RemoveRecord(const RecordPtr& record) {
   auto matches = records_.equal_range(record->range().start());
   for (auto it = matches.first; it != matches.second; ++it) {
     if (it->second.get() == record.get()) {
+      bool removed = record_index_.Remove(record->range(), record.get());
+      DCHECK(removed);
       records_.erase(it);
       return true;
     }
@@ -399,6 +399,15 @@ TEST(ProcessStateTest, RemoveRecord) {
   ASSERT_TRUE(bytes_layer->RemoveRecord(record));
   ASSERT_EQ(0, bytes_layer->size());
 
+  // The record is no longer found by range.
+  std::vector<BytesRecordPtr> matching_records;
+  bytes_layer->GetRecordsIntersecting(AddressRange(kAddress, kSize),
+                                      &matching_records);
+  ASSERT_EQ(0, matching_records.size());
+  bytes_layer->GetRecordsSpanning(AddressRange(kAddress, 1U),
+                                  &matching_records);
+  ASSERT_EQ(0, matching_records.size());
+
   // Removing a second time fails.
   ASSERT_FALSE(bytes_layer->RemoveRecord(record));
 }
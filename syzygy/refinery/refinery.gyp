@@ -56,7 +56,10 @@
         'analyzers/unloaded_module_analyzer_unittest.cc',
         'core/address_unittest.cc',
         'core/addressed_data_unittest.cc',
+        'core/interval_tree_unittest.cc',
+        'core/page_cache_bit_source_unittest.cc',
         'detectors/lfh_entry_detector_unittest.cc',
+        'process_state/caching_bit_source_unittest.cc',
         'process_state/layer_data_unittest.cc',
         'process_state/process_state_unittest.cc',
         'process_state/process_state_util_unittest.cc',
@@ -65,6 +68,7 @@
         'symbols/symbol_provider_util_unittest.cc',
         'types/type_unittest.cc',
         'types/type_repository_unittest.cc',
+        'types/type_repository_snapshot_unittest.cc',
         'types/typed_data_unittest.cc',
         'types/dia_crawler_unittest.cc',
         'types/pdb_crawler_unittest.cc',
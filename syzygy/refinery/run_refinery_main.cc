@@ -19,17 +19,13 @@
 
 #include "base/command_line.h"
 #include "base/logging.h"
+#include "base/sys_info.h"
 #include "base/files/file_path.h"
 #include "base/strings/stringprintf.h"
 #include "syzygy/minidump/minidump.h"
 #include "syzygy/refinery/analyzers/analysis_runner.h"
+#include "syzygy/refinery/analyzers/analyzer_factory.h"
 #include "syzygy/refinery/analyzers/analyzer_util.h"
-#include "syzygy/refinery/analyzers/exception_analyzer.h"
-#include "syzygy/refinery/analyzers/heap_analyzer.h"
-#include "syzygy/refinery/analyzers/memory_analyzer.h"
-#include "syzygy/refinery/analyzers/module_analyzer.h"
-#include "syzygy/refinery/analyzers/stack_analyzer.h"
-#include "syzygy/refinery/analyzers/thread_analyzer.h"
 #include "syzygy/refinery/process_state/process_state.h"
 #include "syzygy/refinery/process_state/process_state_util.h"
 #include "syzygy/refinery/process_state/refinery.pb.h"
@@ -47,13 +43,19 @@ using refinery::ValidationReport;
 using refinery::Validator;
 
 const char kUsage[] =
-  "Usage: %ls --dump=<dump file>\n"
+  "Usage: %ls --dump=<dump file> [--type-snapshots=<dir>]\n"
   "\n"
   "  Runs the refinery analysis and validation, then prints the validation \n"
-  "  report.\n";
+  "  report.\n"
+  "\n"
+  "  --type-snapshots names a directory holding snapshots of the types of\n"
+  "  the modules, so that the types shared by many dumps are only crawled\n"
+  "  once.\n";
 
 bool ParseCommandLine(const base::CommandLine* cmd,
-                      base::FilePath* dump_path) {
+                      base::FilePath* dump_path,
+                      base::FilePath* type_snapshots_path) {
+  *type_snapshots_path = cmd->GetSwitchValuePath("type-snapshots");
   *dump_path = cmd->GetSwitchValuePath("dump");
   if (dump_path->empty()) {
     LOG(ERROR) << "Missing dump file.";
@@ -64,24 +66,32 @@ bool ParseCommandLine(const base::CommandLine* cmd,
   return true;
 }
 
-bool Analyze(const Minidump& minidump, ProcessState* process_state) {
-  AnalysisRunner runner;
+bool Analyze(const Minidump& minidump,
+             const base::FilePath& type_snapshots_path,
+             ProcessState* process_state) {
+  static const char* const kAnalyzerNames[] = {
+      "MemoryAnalyzer", "ThreadAnalyzer", "ExceptionAnalyzer",
+      "ModuleAnalyzer", "HeapAnalyzer",   "StackAnalyzer",
+  };
 
-  std::unique_ptr<Analyzer> analyzer(new refinery::MemoryAnalyzer());
-  runner.AddAnalyzer(std::move(analyzer));
-  analyzer.reset(new refinery::ThreadAnalyzer());
-  runner.AddAnalyzer(std::move(analyzer));
-  analyzer.reset(new refinery::ExceptionAnalyzer());
-  runner.AddAnalyzer(std::move(analyzer));
-  analyzer.reset(new refinery::ModuleAnalyzer());
-  runner.AddAnalyzer(std::move(analyzer));
-  analyzer.reset(new refinery::HeapAnalyzer());
-  runner.AddAnalyzer(std::move(analyzer));
-  analyzer.reset(new refinery::StackAnalyzer());
-  runner.AddAnalyzer(std::move(analyzer));
+  // The analyzers that share no layer run concurrently.
+  refinery::StaticAnalyzerFactory factory;
+  AnalysisRunner runner;
+  runner.set_worker_count(base::SysInfo::NumberOfProcessors());
+  for (const char* name : kAnalyzerNames) {
+    std::unique_ptr<Analyzer> analyzer(factory.CreateAnalyzer(name));
+    AnalysisRunner::Layers input_layers;
+    AnalysisRunner::Layers output_layers;
+    if (!analyzer || !factory.GetInputLayers(name, &input_layers) ||
+        !factory.GetOutputLayers(name, &output_layers)) {
+      LOG(ERROR) << "No such analyzer " << name;
+      return false;
+    }
+    runner.AddAnalyzer(std::move(analyzer), input_layers, output_layers);
+  }
 
   scoped_refptr<refinery::SymbolProvider> symbol_provider(
-      new refinery::SymbolProvider());
+      new refinery::SymbolProvider(type_snapshots_path));
   scoped_refptr<refinery::DiaSymbolProvider> dia_symbol_provider(
       new refinery::DiaSymbolProvider());
 
@@ -109,10 +119,13 @@ int main(int argc, const char* const* argv) {
 
   // Get the dump.
   base::FilePath dump_path;
-  if (!ParseCommandLine(base::CommandLine::ForCurrentProcess(), &dump_path))
+  base::FilePath type_snapshots_path;
+  if (!ParseCommandLine(base::CommandLine::ForCurrentProcess(), &dump_path,
+                        &type_snapshots_path)) {
     return 1;
+  }
 
-  minidump::FileMinidump minidump;
+  minidump::MappedMinidump minidump;
   if (!minidump.Open(dump_path)) {
     LOG(ERROR) << "Unable to open dump file.";
     return 1;
@@ -120,7 +133,7 @@ int main(int argc, const char* const* argv) {
 
   // Analyze.
   ProcessState process_state;
-  if (!Analyze(minidump, &process_state))
+  if (!Analyze(minidump, type_snapshots_path, &process_state))
     return 1;
 
   // Validate and output.
@@ -16,6 +16,8 @@
 
 #include <string>
 
+#include "base/bind.h"
+#include "base/files/file_util.h"
 #include "base/strings/stringprintf.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/pe/dia_util.h"
@@ -27,6 +29,11 @@ namespace refinery {
 DiaSymbolProvider::DiaSymbolProvider() {
 }
 
+DiaSymbolProvider::DiaSymbolProvider(size_t max_cached_pdb_bytes)
+    : pdb_sessions_(max_cached_pdb_bytes,
+                    base::Bind(&DiaSymbolProvider::GetPdbSessionCost)) {
+}
+
 DiaSymbolProvider::~DiaSymbolProvider() {
 }
 
@@ -68,6 +75,10 @@ void DiaSymbolProvider::GetCacheKey(const pe::PEFile::Signature& signature,
                       signature.module_time_date_stamp);
 }
 
+size_t DiaSymbolProvider::GetPdbSessionCost(const PdbSession& pdb_session) {
+  return pdb_session.pdb_size;
+}
+
 bool DiaSymbolProvider::GetOrLoad(
     const pe::PEFile::Signature& signature,
     base::win::ScopedComPtr<IDiaDataSource>* source,
@@ -79,26 +90,25 @@ bool DiaSymbolProvider::GetOrLoad(
   base::string16 cache_key;
   GetCacheKey(signature, &cache_key);
 
-  // Look for a pre-existing entry.
-  auto session_it = pdb_sessions_.find(cache_key);
-  if (session_it != pdb_sessions_.end()) {
-    if (session_it->second == nullptr)
-      return false;  // Negative cache entry.
+  SimpleCache<PdbSession>::LoadingCallback load_cb =
+      base::Bind(&DiaSymbolProvider::CreatePdbSession, base::Unretained(this),
+                 signature);
 
-    auto source_it = pdb_sources_.find(cache_key);
-    // Consistency validation: if there's a session, there should be a source.
-    DCHECK(source_it != pdb_sources_.end());
-    DCHECK(session_it->second.get() != nullptr);
+  scoped_refptr<PdbSession> pdb_session;
+  pdb_sessions_.GetOrLoad(cache_key, load_cb, &pdb_session);
+  if (pdb_session.get() == nullptr)
+    return false;
 
-    *source = source_it->second;
-    *session = session_it->second;
-    return true;
-  }
+  *source = pdb_session->source;
+  *session = pdb_session->session;
+  return true;
+}
 
-  // The module is not in the cache. Create negative cache entries, which will
-  // be replaced on success.
-  pdb_sources_[cache_key] = base::win::ScopedComPtr<IDiaDataSource>();
-  pdb_sessions_[cache_key] = base::win::ScopedComPtr<IDiaSession>();
+bool DiaSymbolProvider::CreatePdbSession(
+    const pe::PEFile::Signature& signature,
+    scoped_refptr<PdbSession>* pdb_session) {
+  DCHECK(pdb_session);
+  *pdb_session = nullptr;
 
   // Attempt to create a dia session for the module.
   base::FilePath pdb_path;
@@ -111,16 +121,17 @@ bool DiaSymbolProvider::GetOrLoad(
     return false;
 
   // Get the session.
-  base::win::ScopedComPtr<IDiaSession> pdb_session;
-  if (!pe::CreateDiaSession(pdb_path, pdb_source.get(), pdb_session.Receive()))
+  base::win::ScopedComPtr<IDiaSession> dia_session;
+  if (!pe::CreateDiaSession(pdb_path, pdb_source.get(), dia_session.Receive()))
     return false;
 
-  // Cache source and session.
-  pdb_sources_[cache_key] = pdb_source;
-  pdb_sessions_[cache_key] = pdb_session;
+  // A size that can't be read only affects the accounting of the cache.
+  int64_t pdb_size = 0;
+  if (!base::GetFileSize(pdb_path, &pdb_size))
+    LOG(WARNING) << "Unable to get the size of " << pdb_path.value() << ".";
 
-  *source = pdb_source;
-  *session = pdb_session;
+  *pdb_session =
+      new PdbSession(pdb_source, dia_session, static_cast<size_t>(pdb_size));
   return true;
 }
 
@@ -24,6 +24,7 @@
 #include "base/win/scoped_comptr.h"
 #include "syzygy/pe/pe_file.h"
 #include "syzygy/refinery/core/address.h"
+#include "syzygy/refinery/symbols/simple_cache.h"
 
 namespace refinery {
 
@@ -37,6 +38,10 @@ namespace refinery {
 class DiaSymbolProvider : public base::RefCounted<DiaSymbolProvider> {
  public:
   DiaSymbolProvider();
+  // @param max_cached_pdb_bytes the total size of the PDB files past which the
+  //     least recently used sessions are released, or 0 to keep them all.
+  //     The size of its PDB file approximates the memory held by a session.
+  explicit DiaSymbolProvider(size_t max_cached_pdb_bytes);
   virtual ~DiaSymbolProvider();
 
   // Retrieves or creates an IDiaSession for the module corresponding to @p
@@ -59,25 +64,48 @@ class DiaSymbolProvider : public base::RefCounted<DiaSymbolProvider> {
                               base::hash_set<RelativeAddress>* vftable_rvas);
 
  private:
+  // A dia pdb file source and its session, which are cached together.
+  class PdbSession : public base::RefCounted<PdbSession> {
+   public:
+    PdbSession(base::win::ScopedComPtr<IDiaDataSource> source,
+               base::win::ScopedComPtr<IDiaSession> session,
+               size_t pdb_size)
+        : source(source), session(session), pdb_size(pdb_size) {}
+
+    base::win::ScopedComPtr<IDiaDataSource> source;
+    base::win::ScopedComPtr<IDiaSession> session;
+    // The size of the pdb file, in bytes.
+    size_t pdb_size;
+
+   private:
+    friend class base::RefCounted<PdbSession>;
+    ~PdbSession() {}
+
+    DISALLOW_COPY_AND_ASSIGN(PdbSession);
+  };
+
   // TODO(manzagop): this function is duplicated in SymbolProvider. It should
   // likely be extracted to a cross-platform Signature class.
   static void GetCacheKey(const pe::PEFile::Signature& signature,
                           base::string16* cache_key);
 
+  // @returns the cost of @p pdb_session in the cache.
+  static size_t GetPdbSessionCost(const PdbSession& pdb_session);
+
   bool GetOrLoad(const pe::PEFile::Signature& signature,
                  base::win::ScopedComPtr<IDiaDataSource>* source,
                  base::win::ScopedComPtr<IDiaSession>* session);
 
-  // Caching for dia pdb file sources and sessions (matching entries). The cache
-  // key is "<basename>:<size>:<checksum>:<timestamp>". The cache may contain
-  // negative entries (indicating a failed attempt at creating a session) in the
-  // form of null pointers.
-  // The caches must be consistent: the presence of a valid source implies the
-  // presence of a valid session, and vice versa.
-  std::unordered_map<base::string16, base::win::ScopedComPtr<IDiaDataSource>>
-      pdb_sources_;
-  std::unordered_map<base::string16, base::win::ScopedComPtr<IDiaSession>>
-      pdb_sessions_;
+  // Creates a source and session for the module of @p signature (without
+  // caching them).
+  bool CreatePdbSession(const pe::PEFile::Signature& signature,
+                        scoped_refptr<PdbSession>* pdb_session);
+
+  // Caching for dia pdb file sources and their sessions. The cache key is
+  // "<basename>:<size>:<checksum>:<timestamp>". The cache may contain
+  // negative entries (indicating a failed attempt at creating a session) in
+  // the form of null pointers.
+  SimpleCache<PdbSession> pdb_sessions_;
 
   DISALLOW_COPY_AND_ASSIGN(DiaSymbolProvider);
 };
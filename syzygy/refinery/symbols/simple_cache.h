@@ -15,6 +15,11 @@
 #ifndef SYZYGY_REFINERY_SYMBOLS_SIMPLE_CACHE_H_
 #define SYZYGY_REFINERY_SYMBOLS_SIMPLE_CACHE_H_
 
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
 #include "base/callback.h"
 #include "base/logging.h"
 #include "base/macros.h"
@@ -25,20 +30,35 @@
 namespace refinery {
 
 // A simple cache which uses negative entries in the form of null pointers.
+//
+// The cache may be bounded, in which case each entry has a cost, such as its
+// approximate memory footprint, and the least recently used entries are
+// evicted once the total cost of the entries exceeds the bound. Evicting an
+// entry only releases the cache's reference to it.
 template <typename EntryType>
 class SimpleCache {
  public:
   typedef base::Callback<bool(scoped_refptr<EntryType>*)> LoadingCallback;
-
-  SimpleCache() {}
+  typedef base::Callback<size_t(const EntryType&)> CostCallback;
+
+  // Creates an unbounded cache.
+  SimpleCache() : max_cost_(0U), total_cost_(0U) {}
+
+  // Creates a bounded cache.
+  // @param max_cost the total cost past which entries are evicted, or 0 for
+  //     an unbounded cache.
+  // @param cost_cb returns the cost of an entry. Negative entries cost 1, as
+  //     do all entries if @p cost_cb is null.
+  SimpleCache(size_t max_cost, const CostCallback& cost_cb)
+      : max_cost_(max_cost), total_cost_(0U), cost_cb_(cost_cb) {}
   ~SimpleCache() {}
 
-  // Retrieves a cache entry.
+  // Retrieves a cache entry, and marks it as the most recently used.
   // @param key the desired entry's cache key.
   // @param entry on success, returns the desired entry or nullptr to indicate a
   //     negative entry.
   // @returns true if the cache contains an entry for @p key, false otherwise.
-  bool Get(const base::string16& key, scoped_refptr<EntryType>* entry) const;
+  bool Get(const base::string16& key, scoped_refptr<EntryType>* entry);
 
   // Retrieves a cache entry, loading it if required.
   // @param key the desired entry's cache key.
@@ -49,21 +69,52 @@ class SimpleCache {
                  const LoadingCallback& load_cb,
                  scoped_refptr<EntryType>* entry);
 
-  // Stores a cache entry.
+  // Stores a cache entry as the most recently used, then evicts the least
+  // recently used entries if the cache is over its bound. The entry itself is
+  // never evicted by its own storing.
   // @note replaces any previous entry at @p key.
   // @param key the key to store at.
   // @param entry the entry to store at @p key.
   void Store(const base::string16& key, scoped_refptr<EntryType> entry);
 
+  // @name Accessors.
+  // @{
+  size_t size() const { return entries_.size(); }
+  size_t max_cost() const { return max_cost_; }
+  size_t total_cost() const { return total_cost_; }
+  // @}
+
  private:
-  std::unordered_map<base::string16, scoped_refptr<EntryType>> entries_;
+  typedef std::list<base::string16> KeyList;
+
+  struct CacheEntry {
+    scoped_refptr<EntryType> entry;
+    size_t cost;
+    // The position of the entry's key in lru_.
+    typename KeyList::iterator lru_it;
+  };
+
+  // @returns the cost of @p entry.
+  size_t GetCost(const scoped_refptr<EntryType>& entry) const;
+
+  // Evicts the least recently used entries until the cache is within its
+  // bound, sparing the most recently used one.
+  void Evict();
+
+  std::unordered_map<base::string16, CacheEntry> entries_;
+  // The keys of entries_, from the most to the least recently used.
+  KeyList lru_;
+
+  size_t max_cost_;
+  size_t total_cost_;
+  CostCallback cost_cb_;
 
   DISALLOW_COPY_AND_ASSIGN(SimpleCache);
 };
 
 template <typename EntryType>
 bool SimpleCache<EntryType>::Get(const base::string16& key,
-                                 scoped_refptr<EntryType>* entry) const {
+                                 scoped_refptr<EntryType>* entry) {
   DCHECK(entry);
   *entry = nullptr;
 
@@ -71,7 +122,8 @@ bool SimpleCache<EntryType>::Get(const base::string16& key,
   if (it == entries_.end())
     return false;  // Not present in the cache.
 
-  *entry = it->second;
+  lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+  *entry = it->second.entry;
   return true;
 }
 
@@ -98,7 +150,47 @@ void SimpleCache<EntryType>::GetOrLoad(const base::string16& key,
 template <typename EntryType>
 void SimpleCache<EntryType>::Store(const base::string16& key,
                                    scoped_refptr<EntryType> entry) {
-  entries_[key] = entry;
+  size_t cost = GetCost(entry);
+
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    total_cost_ -= it->second.cost;
+    lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+  } else {
+    lru_.push_front(key);
+    it = entries_.insert(std::make_pair(key, CacheEntry())).first;
+    it->second.lru_it = lru_.begin();
+  }
+
+  it->second.entry = entry;
+  it->second.cost = cost;
+  total_cost_ += cost;
+
+  Evict();
+}
+
+template <typename EntryType>
+size_t SimpleCache<EntryType>::GetCost(
+    const scoped_refptr<EntryType>& entry) const {
+  if (entry.get() == nullptr || cost_cb_.is_null())
+    return 1U;
+  return std::max<size_t>(1U, cost_cb_.Run(*entry));
+}
+
+template <typename EntryType>
+void SimpleCache<EntryType>::Evict() {
+  if (max_cost_ == 0U)
+    return;
+
+  while (total_cost_ > max_cost_ && lru_.size() > 1U) {
+    auto it = entries_.find(lru_.back());
+    DCHECK(it != entries_.end());
+    DCHECK_LE(it->second.cost, total_cost_);
+
+    total_cost_ -= it->second.cost;
+    entries_.erase(it);
+    lru_.pop_back();
+  }
 }
 
 }  // namespace refinery
@@ -24,6 +24,8 @@ namespace refinery {
 namespace {
 
 const wchar_t kCacheKeyOne[] = L"cache-key-one";
+const wchar_t kCacheKeyTwo[] = L"cache-key-two";
+const wchar_t kCacheKeyThree[] = L"cache-key-three";
 
 class SimpleEntry : public base::RefCounted<SimpleEntry> {
  public:
@@ -33,6 +35,8 @@ class SimpleEntry : public base::RefCounted<SimpleEntry> {
     return value_ == other.value_;
   }
 
+  int value() const { return value_; }
+
  private:
   friend class base::RefCounted<SimpleEntry>;
   ~SimpleEntry() {}
@@ -68,6 +72,11 @@ class SimpleCacheLoadingTest : public testing::Test {
   int load_cnt_;
 };
 
+// The cost of an entry is its value.
+size_t GetSimpleEntryCost(const SimpleEntry& entry) {
+  return entry.value();
+}
+
 }  // namespace
 
 TEST(SimpleCacheTest, BasicTest) {
@@ -141,4 +150,43 @@ TEST_F(SimpleCacheLoadingTest, LoadingSucceedsTest) {
 }
 
 
+TEST(SimpleCacheTest, EvictsLeastRecentlyUsed) {
+  SimpleCache<SimpleEntry> cache(10U, base::Bind(&GetSimpleEntryCost));
+  cache.Store(kCacheKeyOne, new SimpleEntry(4));
+  cache.Store(kCacheKeyTwo, new SimpleEntry(4));
+  EXPECT_EQ(8U, cache.total_cost());
+
+  // Using the first entry makes the second the least recently used.
+  scoped_refptr<SimpleEntry> retrieved;
+  ASSERT_TRUE(cache.Get(kCacheKeyOne, &retrieved));
+  cache.Store(kCacheKeyThree, new SimpleEntry(4));
+  EXPECT_EQ(2U, cache.size());
+  EXPECT_EQ(8U, cache.total_cost());
+  EXPECT_FALSE(cache.Get(kCacheKeyTwo, &retrieved));
+  EXPECT_TRUE(cache.Get(kCacheKeyOne, &retrieved));
+  EXPECT_TRUE(cache.Get(kCacheKeyThree, &retrieved));
+
+  // An evicted entry outlives the cache's reference to it.
+  scoped_refptr<SimpleEntry> one;
+  ASSERT_TRUE(cache.Get(kCacheKeyOne, &one));
+  cache.Store(kCacheKeyTwo, new SimpleEntry(20));
+  EXPECT_EQ(1U, cache.size());
+  EXPECT_EQ(20U, cache.total_cost());
+  EXPECT_FALSE(cache.Get(kCacheKeyOne, &retrieved));
+  EXPECT_EQ(4, one->value());
+
+  // Replacing an entry updates the total cost. Negative entries cost 1.
+  cache.Store(kCacheKeyTwo, nullptr);
+  EXPECT_EQ(1U, cache.total_cost());
+}
+
+TEST(SimpleCacheTest, UnboundedCacheKeepsEverything) {
+  SimpleCache<SimpleEntry> cache;
+  cache.Store(kCacheKeyOne, new SimpleEntry(1000));
+  cache.Store(kCacheKeyTwo, new SimpleEntry(1000));
+  cache.Store(kCacheKeyThree, nullptr);
+  EXPECT_EQ(3U, cache.size());
+  EXPECT_EQ(3U, cache.total_cost());
+}
+
 }  // namespace refinery
@@ -15,15 +15,31 @@
 #include "syzygy/refinery/symbols/symbol_provider.h"
 
 #include "base/bind.h"
+#include "base/files/file_util.h"
 #include "base/strings/stringprintf.h"
+#include "syzygy/pdb/pdb_util.h"
 #include "syzygy/refinery/symbols/symbol_provider_util.h"
 #include "syzygy/refinery/types/pdb_crawler.h"
+#include "syzygy/refinery/types/type_repository_snapshot.h"
 
 namespace refinery {
 
 SymbolProvider::SymbolProvider() {
 }
 
+SymbolProvider::SymbolProvider(const base::FilePath& snapshot_directory)
+    : snapshot_directory_(snapshot_directory) {
+}
+
+SymbolProvider::SymbolProvider(const base::FilePath& snapshot_directory,
+                               size_t max_cached_types)
+    : type_repos_(max_cached_types,
+                  base::Bind(&SymbolProvider::GetTypeRepositoryCost)),
+      typename_indices_(max_cached_types,
+                        base::Bind(&SymbolProvider::GetTypeNameIndexCost)),
+      snapshot_directory_(snapshot_directory) {
+}
+
 SymbolProvider::~SymbolProvider() {
 }
 
@@ -86,6 +102,16 @@ void SymbolProvider::GetCacheKey(const pe::PEFile::Signature& signature,
                       signature.module_time_date_stamp);
 }
 
+size_t SymbolProvider::GetTypeRepositoryCost(
+    const TypeRepository& type_repo) {
+  return type_repo.GetApproximateSize();
+}
+
+size_t SymbolProvider::GetTypeNameIndexCost(
+    const TypeNameIndex& typename_index) {
+  return typename_index.size();
+}
+
 bool SymbolProvider::CreateTypeRepository(
     const pe::PEFile::Signature& signature,
     scoped_refptr<TypeRepository>* type_repo) {
@@ -96,6 +122,24 @@ bool SymbolProvider::CreateTypeRepository(
   if (!GetPdbPath(signature, &pdb_path))
     return false;
 
+  // Reuse the snapshot of the types of the PDB, if there is one. Only the
+  // header of the PDB is read to find it.
+  pdb::PdbInfoHeader70 pdb_header = {};
+  base::FilePath snapshot_path;
+  if (!snapshot_directory_.empty() &&
+      pdb::ReadPdbHeader(pdb_path, &pdb_header)) {
+    snapshot_path = TypeRepositorySnapshot::GetPath(
+        snapshot_directory_, pdb_header.signature, pdb_header.pdb_age);
+    scoped_refptr<TypeRepositorySnapshot> snapshot =
+        new TypeRepositorySnapshot();
+    if (base::PathExists(snapshot_path) && snapshot->Open(snapshot_path) &&
+        snapshot->pdb_signature() == pdb_header.signature &&
+        snapshot->pdb_age() == pdb_header.pdb_age) {
+      *type_repo = new TypeRepository(snapshot);
+      return true;
+    }
+  }
+
   scoped_refptr<TypeRepository> repository = new TypeRepository();
   PdbCrawler crawler;
   if (!crawler.InitializeForFile(pdb_path) ||
@@ -103,6 +147,13 @@ bool SymbolProvider::CreateTypeRepository(
     return false;
   }
 
+  // A snapshot that can't be written only costs later analyses some time.
+  if (!snapshot_path.empty() &&
+      !TypeRepositorySnapshot::Write(*repository, pdb_header.signature,
+                                     pdb_header.pdb_age, snapshot_path)) {
+    LOG(WARNING) << "Unable to write type repository snapshot.";
+  }
+
   *type_repo = repository;
   return true;
 }
@@ -19,6 +19,7 @@
 
 #include "base/macros.h"
 #include "base/containers/hash_tables.h"
+#include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
 #include "base/strings/string16.h"
 #include "syzygy/pe/pe_file.h"
@@ -33,6 +34,18 @@ namespace refinery {
 class SymbolProvider : public base::RefCounted<SymbolProvider> {
  public:
   SymbolProvider();
+  // @param snapshot_directory a directory of type repository snapshots, see
+  //     TypeRepositorySnapshot. The types of a module are read from its
+  //     snapshot when there is one, and a snapshot is written after crawling
+  //     them otherwise. If empty, types are always crawled.
+  explicit SymbolProvider(const base::FilePath& snapshot_directory);
+  // @param snapshot_directory see above.
+  // @param max_cached_types the number of types past which the least recently
+  //     used type repositories and typename indices are dropped from memory,
+  //     or 0 to keep them all. Dropped type repositories are cheaply reloaded
+  //     when they have a snapshot.
+  SymbolProvider(const base::FilePath& snapshot_directory,
+                 size_t max_cached_types);
   // @note virtual to enable mocking.
   virtual ~SymbolProvider();
 
@@ -78,13 +91,21 @@ class SymbolProvider : public base::RefCounted<SymbolProvider> {
   bool CreateTypeNameIndex(const pe::PEFile::Signature& signature,
                            scoped_refptr<TypeNameIndex>* index);
 
+  // @returns the cost of type repositories and typename indices in the
+  //     caches, which is their number of types.
+  static size_t GetTypeRepositoryCost(const TypeRepository& type_repo);
+  static size_t GetTypeNameIndexCost(const TypeNameIndex& typename_index);
+
   // Caching for type repositories and typename indices. The cache key is
   // "<basename>:<size>:<checksum>:<timestamp>". The caches may contain
   // negative entries (indicating a failed attempt at creating a session) in the
   // form of null pointers.
+  // Each cache is independently bounded by the number of types it holds.
   SimpleCache<TypeRepository> type_repos_;
   SimpleCache<TypeNameIndex> typename_indices_;
 
+  base::FilePath snapshot_directory_;
+
   DISALLOW_COPY_AND_ASSIGN(SymbolProvider);
 };
 
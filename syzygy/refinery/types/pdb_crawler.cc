@@ -15,6 +15,7 @@
 #include "syzygy/refinery/types/pdb_crawler.h"
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "base/bind.h"
@@ -47,13 +48,33 @@ const uint16_t kNoLeafType = static_cast<uint16_t>(-1);
 
 class TypeCreator {
  public:
-  TypeCreator(TypeRepository* repository, pdb::PdbStream* stream);
+  // @param repository the repository to populate.
+  // @param stream the type info stream.
+  // @param hash_stream the type info hash stream, used to seek quickly
+  //     through @p stream. May be null.
+  TypeCreator(TypeRepository* repository,
+              pdb::PdbStream* stream,
+              pdb::PdbStream* hash_stream);
   ~TypeCreator();
 
   // Crawls @p stream_, creates all types and assigns names to pointers.
   // @returns true on success, false on failure.
   bool CreateTypes();
 
+  // Creates the types of the records of @p type_ids, and the types they
+  // depend on. No other type record is translated.
+  // @param type_ids the type indices of the types to create.
+  // @returns true on success, false on failure, including when an index
+  //     doesn't refer to a basic type or a type record.
+  bool CreateTypesForIds(const std::vector<TypeId>& type_ids);
+
+  // Creates the user defined types named @p name, and the types they depend
+  // on. No other type record is translated.
+  // @param name the name of the user defined types to create.
+  // @returns true on success, false on failure. Finding no user defined type
+  //     named @p name is a success.
+  bool CreateTypesForName(const base::string16& name);
+
  private:
   // The following functions parse objects from the data stream.
   // @returns pointer to the created object or nullptr on failure.
@@ -155,6 +176,10 @@ class TypeCreator {
   // TODO(manzagop): Add a typedef for the leaf type.
   uint16_t GetLeafType(TypeId type_id);
 
+  // Initializes the type info enumerator and prepares the data.
+  // @returns true on success, false on failure.
+  bool Init();
+
   // Does a first pass through the stream making the map of type indices for
   // UDT and saves indices of all types that will get translated to the type
   // repo.
@@ -245,10 +270,17 @@ class TypeCreator {
   // Type info enumerator used to traverse the stream.
   pdb::TypeInfoEnumerator type_info_enum_;
 
+  // The type info hash stream. May be null.
+  scoped_refptr<pdb::PdbStream> hash_stream_;
+
   // Hash to map forward references to the right UDT records. For each unique
   // decorated name of an UDT, it contains type index of the class definition.
   std::unordered_map<base::string16, TypeId> udt_map_;
 
+  // The type indices of the UDT definitions, by name. Names aren't unique,
+  // e.g. for the unnamed nested structures.
+  std::unordered_multimap<base::string16, TypeId> udt_names_;
+
   // Hash to store the pdb leaf types of the individual records. Indexed by type
   // indices.
   std::unordered_map<TypeId, uint16_t> types_map_;
@@ -791,8 +823,12 @@ TypePtr TypeCreator::ReadBitfield(TypeId type_id,
   return FindOrCreateBitfieldType(underlying_id, flags);
 }
 
-TypeCreator::TypeCreator(TypeRepository* repository, pdb::PdbStream* stream)
-    : type_info_enum_(stream), repository_(repository) {
+TypeCreator::TypeCreator(TypeRepository* repository,
+                         pdb::PdbStream* stream,
+                         pdb::PdbStream* hash_stream)
+    : type_info_enum_(stream),
+      hash_stream_(hash_stream),
+      repository_(repository) {
   DCHECK(repository);
   DCHECK(stream);
 }
@@ -1373,6 +1409,19 @@ bool TypeCreator::PrepareData() {
         }
 
         udt_map_[type_info.decorated_name()] = type_info_enum_.type_id();
+        udt_names_.insert(
+            std::make_pair(type_info.name(), type_info_enum_.type_id()));
+      }
+    } else if (type_info_enum_.type() == cci::LF_UNION) {
+      pdb::LeafUnion type_info;
+      if (!type_info.Initialize(&parser)) {
+        LOG(ERROR) << "Unable to read type info record.";
+        return false;
+      }
+
+      if (!type_info.property().fwdref) {
+        udt_names_.insert(
+            std::make_pair(type_info.name(), type_info_enum_.type_id()));
       }
     }
   }
@@ -1385,12 +1434,20 @@ bool TypeCreator::PrepareData() {
   return type_info_enum_.ResetStream();
 }
 
-bool TypeCreator::CreateTypes() {
+bool TypeCreator::Init() {
   if (!type_info_enum_.Init()) {
     LOG(ERROR) << "Unable to initialize type info stream enumerator.";
     return false;
   }
 
+  // Type records are visited in dependency order, so seeking is frequent.
+  // Without the index offsets it still works, just more slowly.
+  if (hash_stream_.get() != nullptr &&
+      !type_info_enum_.InitTypeIndexOffsets(hash_stream_.get())) {
+    LOG(WARNING) << "Unable to use the type index offsets, seeking will scan "
+                 << "the type info stream.";
+  }
+
   const TypeId kSmallestUnreservedIndex = 0x1000;
   if (type_info_enum_.type_info_header().type_min < kSmallestUnreservedIndex) {
     LOG(ERROR) << "Degenerate stream with type indices in the reserved range.";
@@ -1398,7 +1455,11 @@ bool TypeCreator::CreateTypes() {
   }
 
   // Create the map of forward declarations and populate the process queue.
-  if (!PrepareData())
+  return PrepareData();
+}
+
+bool TypeCreator::CreateTypes() {
+  if (!Init())
     return false;
 
   // Process every important type.
@@ -1410,6 +1471,36 @@ bool TypeCreator::CreateTypes() {
   return true;
 }
 
+bool TypeCreator::CreateTypesForIds(const std::vector<TypeId>& type_ids) {
+  if (!Init())
+    return false;
+
+  for (TypeId type_id : type_ids) {
+    if (type_id >= cci::CV_PRIMITIVE_TYPE::CV_FIRST_NONPRIM &&
+        types_map_.find(type_id) == types_map_.end()) {
+      LOG(ERROR) << "No type record with type index " << type_id << ".";
+      return false;
+    }
+    if (FindOrCreateTypeImpl(type_id) == nullptr)
+      return false;
+  }
+
+  return true;
+}
+
+bool TypeCreator::CreateTypesForName(const base::string16& name) {
+  if (!Init())
+    return false;
+
+  auto matches = udt_names_.equal_range(name);
+  for (auto it = matches.first; it != matches.second; ++it) {
+    if (FindOrCreateTypeImpl(it->second) == nullptr)
+      return false;
+  }
+
+  return true;
+}
+
 }  // namespace
 
 PdbCrawler::PdbCrawler() {
@@ -1422,21 +1513,29 @@ bool PdbCrawler::InitializeForFile(const base::FilePath& path) {
   pdb::PdbReader reader;
   pdb::PdbFile pdb_file;
 
-  if (!reader.Read(path, &pdb_file)) {
+  if (!reader.ReadMapped(path, &pdb_file)) {
     LOG(ERROR) << "Failed to read PDB file " << path.value() << ".";
     return false;
   }
 
-  // Get the type stream.
+  // Get the type stream, and the hash stream it references.
   tpi_stream_ = pdb_file.GetStream(pdb::kTpiStream);
+  tpi_hash_stream_ = nullptr;
+  pdb::TypeInfoHeader tpi_header = {};
+  if (tpi_stream_.get() != nullptr &&
+      tpi_stream_->ReadBytesAt(0, sizeof(tpi_header), &tpi_header) &&
+      tpi_header.type_info_hash.stream_number < pdb_file.StreamCount()) {
+    tpi_hash_stream_ =
+        pdb_file.GetStream(tpi_header.type_info_hash.stream_number);
+  }
 
   // Get the public symbol stream: it has a variable index, found in the Dbi
-  // stream.
+  // stream. Only its headers are needed.
   scoped_refptr<pdb::PdbStream> dbi_stream_raw =
       pdb_file.GetStream(pdb::kDbiStream);
   pdb::DbiStream dbi_stream;
   if (dbi_stream_raw.get() == nullptr ||
-      !dbi_stream.Read(dbi_stream_raw.get())) {
+      !dbi_stream.Init(dbi_stream_raw.get())) {
     LOG(ERROR) << "No Dbi stream.";
     return false;
   }
@@ -1487,6 +1586,7 @@ bool PdbCrawler::InitializeForFile(const base::FilePath& path) {
       LOG(ERROR) << "Failed to read the OMAP data.";
       return false;
     }
+    omap_from_index_.Init(omap_from_);
   }
 
   return true;
@@ -1496,11 +1596,31 @@ bool PdbCrawler::GetTypes(TypeRepository* types) {
   DCHECK(types);
   DCHECK(tpi_stream_);
 
-  TypeCreator creator(types, tpi_stream_.get());
+  TypeCreator creator(types, tpi_stream_.get(), tpi_hash_stream_.get());
 
   return creator.CreateTypes();
 }
 
+bool PdbCrawler::GetTypesForIds(const std::vector<TypeId>& type_ids,
+                                TypeRepository* types) {
+  DCHECK(types);
+  DCHECK(tpi_stream_);
+
+  TypeCreator creator(types, tpi_stream_.get(), tpi_hash_stream_.get());
+
+  return creator.CreateTypesForIds(type_ids);
+}
+
+bool PdbCrawler::GetTypesForName(const base::string16& name,
+                                 TypeRepository* types) {
+  DCHECK(types);
+  DCHECK(tpi_stream_);
+
+  TypeCreator creator(types, tpi_stream_.get(), tpi_hash_stream_.get());
+
+  return creator.CreateTypesForName(name);
+}
+
 bool PdbCrawler::GetVFTableRVAForSymbol(
     base::hash_set<RelativeAddress>* vftable_rvas,
     uint16_t symbol_length,
@@ -1546,8 +1666,8 @@ bool PdbCrawler::GetVFTableRVAForSymbol(
 
   // Apply OMAP transformation if necessary.
   if (omap_from_.size() > 0) {
-    core::RelativeAddress rva_omap = pdb::TranslateAddressViaOmap(
-        omap_from_, core::RelativeAddress(vftable_rva));
+    core::RelativeAddress rva_omap =
+        omap_from_index_.Translate(core::RelativeAddress(vftable_rva));
     vftable_rva = rva_omap.value();
   }
 
@@ -22,10 +22,13 @@
 
 #include "base/containers/hash_tables.h"
 #include "base/files/file_path.h"
+#include "base/strings/string16.h"
 #include "syzygy/common/binary_stream.h"
+#include "syzygy/pdb/omap.h"
 #include "syzygy/pdb/pdb_dbi_stream.h"
 #include "syzygy/pdb/pdb_stream.h"
 #include "syzygy/refinery/core/address.h"
+#include "syzygy/refinery/types/type.h"
 
 namespace refinery {
 // Forward declaration.
@@ -53,6 +56,25 @@ class PdbCrawler {
   // @returns true on success, false on failure.
   bool GetTypes(TypeRepository* types);
 
+  // Retrieves the types of @p type_ids, and the types they depend on, from
+  // the file this instance is initialized to. Unlike GetTypes, the other type
+  // records are only scanned, not translated, which is much faster when few
+  // types are needed. Types already in @p types are reused.
+  // @param type_ids the PDB type indices of the types to retrieve.
+  // @param types on success contains the types of @p type_ids.
+  // @returns true on success, false on failure, including when an index
+  //     doesn't refer to a type.
+  bool GetTypesForIds(const std::vector<TypeId>& type_ids,
+                      TypeRepository* types);
+
+  // Retrieves the user defined types named @p name, and the types they depend
+  // on, the same way as GetTypesForIds.
+  // @param name the name of the user defined types, e.g. "testing::Foo".
+  // @param types on success contains the user defined types named @p name,
+  //     if there are any.
+  // @returns true on success, false on failure.
+  bool GetTypesForName(const base::string16& name, TypeRepository* types);
+
   // Retrieves the relative virtual addresses of all virtual function tables.
   // @param vftable_rvas on success contains zero or more relative addresses.
   // @returns true on success, false on failure.
@@ -64,8 +86,9 @@ class PdbCrawler {
                               uint16_t symbol_type,
                               common::BinaryStreamReader* symbol_reader);
 
-  // Pointers to the PDB type and symbol streams.
+  // Pointers to the PDB type, type hash and symbol streams.
   scoped_refptr<pdb::PdbStream> tpi_stream_;
+  scoped_refptr<pdb::PdbStream> tpi_hash_stream_;
   scoped_refptr<pdb::PdbStream> sym_stream_;
 
   // The PE section headers extracted from the pdb.
@@ -76,6 +99,8 @@ class PdbCrawler {
   // OMAP data to map from original space to transformed space. Empty if there
   // is no OMAP data.
   std::vector<OMAP> omap_from_;
+  // An index over omap_from_.
+  pdb::OmapIndex omap_from_index_;
 };
 
 }  // namespace refinery
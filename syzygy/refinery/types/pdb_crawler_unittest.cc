@@ -827,6 +827,61 @@ TEST_P(PdbCrawlerTest, TestUnion) {
   ValidateBasicType(udt->GetFieldType(1), sizeof(uint32_t), L"uint32_t");
 }
 
+TEST_P(PdbCrawlerTest, TestGetTypesForIds) {
+  TypePtr type = FindOneTypeBySuffix(L"::TestSimpleUDT");
+  ASSERT_TRUE(type);
+
+  PdbCrawler crawler;
+  ASSERT_TRUE(crawler.InitializeForFile(test_types_file_));
+  scoped_refptr<TypeRepository> types = new TypeRepository();
+  std::vector<TypeId> type_ids = { type->type_id() };
+  ASSERT_TRUE(crawler.GetTypesForIds(type_ids, types.get()));
+
+  // Only the UDT and the types it depends on are translated.
+  EXPECT_LT(types->size(), types_->size());
+  TypePtr lazy_type = types->GetType(type->type_id());
+  ASSERT_TRUE(lazy_type);
+  EXPECT_EQ(type->GetName(), lazy_type->GetName());
+  EXPECT_EQ(type->size(), lazy_type->size());
+
+  UserDefinedTypePtr udt;
+  ASSERT_TRUE(lazy_type->CastTo(&udt));
+  ASSERT_EQ(6U, udt->fields().size());
+  for (size_t i = 0; i < udt->fields().size(); ++i)
+    EXPECT_TRUE(udt->GetFieldType(i));
+
+  // An index past the type records isn't a type.
+  type_ids[0] = 0x7FFFFFFF;
+  EXPECT_FALSE(crawler.GetTypesForIds(type_ids, types.get()));
+}
+
+TEST_P(PdbCrawlerTest, TestGetTypesForName) {
+  TypePtr type = FindOneTypeBySuffix(L"::TestRecursiveUDT");
+  ASSERT_TRUE(type);
+
+  PdbCrawler crawler;
+  ASSERT_TRUE(crawler.InitializeForFile(test_types_file_));
+  scoped_refptr<TypeRepository> types = new TypeRepository();
+  ASSERT_TRUE(crawler.GetTypesForName(type->GetName(), types.get()));
+
+  EXPECT_LT(types->size(), types_->size());
+  TypePtr lazy_type = types->GetType(type->type_id());
+  ASSERT_TRUE(lazy_type);
+
+  // The forward references resolve to the UDT itself.
+  UserDefinedTypePtr udt;
+  ASSERT_TRUE(lazy_type->CastTo(&udt));
+  ASSERT_EQ(2U, udt->fields().size());
+  PointerTypePtr ptr;
+  ASSERT_TRUE(udt->GetFieldType(0)->CastTo(&ptr));
+  EXPECT_EQ(udt, ptr->GetContentType());
+
+  // An unknown name yields no types.
+  scoped_refptr<TypeRepository> no_types = new TypeRepository();
+  EXPECT_TRUE(crawler.GetTypesForName(L"testing::NoSuchType", no_types.get()));
+  EXPECT_EQ(0U, no_types->size());
+}
+
 // Run both the 32-bit and 64-bit tests.
 INSTANTIATE_TEST_CASE_P(InstantiateFor32and64,
                         PdbCrawlerTest,
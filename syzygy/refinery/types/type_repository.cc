@@ -14,16 +14,27 @@
 
 #include "syzygy/refinery/types/type_repository.h"
 
+#include <algorithm>
+
 #include "base/logging.h"
 #include "syzygy/refinery/types/type.h"
+#include "syzygy/refinery/types/type_repository_snapshot.h"
 
 namespace refinery {
 
-TypeRepository::TypeRepository() : is_signature_set_(false) {
+TypeRepository::TypeRepository()
+    : is_signature_set_(false), all_types_decoded_(true) {
 }
 
 TypeRepository::TypeRepository(const pe::PEFile::Signature& signature)
-    : is_signature_set_(true), signature_(signature) {
+    : is_signature_set_(true), signature_(signature),
+      all_types_decoded_(true) {
+}
+
+TypeRepository::TypeRepository(scoped_refptr<TypeRepositorySnapshot> snapshot)
+    : is_signature_set_(false), snapshot_(snapshot),
+      all_types_decoded_(false) {
+  DCHECK(snapshot_);
 }
 
 TypeRepository::~TypeRepository() {
@@ -31,9 +42,20 @@ TypeRepository::~TypeRepository() {
 
 TypePtr TypeRepository::GetType(TypeId id) const {
   auto it = types_.find(id);
-  if (it == types_.end())
+  if (it != types_.end())
+    return it->second;
+  if (all_types_decoded_)
     return nullptr;
-  return it->second;
+
+  // Decoding a type doesn't change the observable state of the repository,
+  // hence the const_cast.
+  TypeRepository* self = const_cast<TypeRepository*>(this);
+  TypePtr type = snapshot_->CreateType(id, self);
+  if (!type)
+    return nullptr;
+  type->SetRepository(self, id);
+  types_[id] = type;
+  return type;
 }
 
 TypeId TypeRepository::AddType(TypePtr type) {
@@ -52,8 +74,10 @@ bool TypeRepository::AddTypeWithId(TypePtr type, TypeId id) {
   DCHECK(type);
 
   // Check that the ID is unassigned.
-  if (types_.find(id) != types_.end())
+  if (types_.find(id) != types_.end() ||
+      (snapshot_ && snapshot_->HasType(id))) {
     return false;
+  }
 
   type->SetRepository(this, id);
   types_[id] = type;
@@ -71,10 +95,18 @@ bool TypeRepository::GetModuleSignature(pe::PEFile::Signature* signature) {
 }
 
 size_t TypeRepository::size() const {
+  DecodeAllTypes();
   return types_.size();
 }
 
+size_t TypeRepository::GetApproximateSize() const {
+  if (!snapshot_ || all_types_decoded_)
+    return types_.size();
+  return std::max(types_.size(), snapshot_->size());
+}
+
 TypeRepository::Iterator TypeRepository::begin() const {
+  DecodeAllTypes();
   return Iterator(types_.begin());
 }
 
@@ -82,6 +114,17 @@ TypeRepository::Iterator TypeRepository::end() const {
   return Iterator(types_.end());
 }
 
+void TypeRepository::DecodeAllTypes() const {
+  if (all_types_decoded_)
+    return;
+
+  std::vector<TypeId> ids;
+  snapshot_->GetTypeIds(&ids);
+  for (TypeId id : ids)
+    GetType(id);
+  all_types_decoded_ = true;
+}
+
 TypeNameIndex::TypeNameIndex(scoped_refptr<TypeRepository> repository) {
   DCHECK(repository);
   for (auto type : *repository)
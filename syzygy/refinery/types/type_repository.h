@@ -16,18 +16,20 @@
 #define SYZYGY_REFINERY_TYPES_TYPE_REPOSITORY_H_
 
 #include <iterator>
-#include <map>
+#include <unordered_map>
 #include <vector>
 
 #include "base/macros.h"
 #include "base/containers/hash_tables.h"
 #include "base/memory/ref_counted.h"
+#include "base/strings/string16.h"
 #include "syzygy/pe/pe_file.h"
 
 namespace refinery {
 
 typedef size_t TypeId;
 class Type;
+class TypeRepositorySnapshot;
 using TypePtr = scoped_refptr<Type>;
 
 // Keeps type instances, assigns them an ID and vends them out by ID on demand.
@@ -41,6 +43,12 @@ class TypeRepository : public base::RefCounted<TypeRepository> {
   TypeRepository();
   explicit TypeRepository(const pe::PEFile::Signature& signature);
 
+  // Creates a repository holding the types of @p snapshot. Types are decoded
+  // from the snapshot the first time they're retrieved, so that lookups by ID
+  // don't pay for decoding the whole repository. Iterating over the
+  // repository decodes all of its types.
+  explicit TypeRepository(scoped_refptr<TypeRepositorySnapshot> snapshot);
+
   // Retrieve a type by @p id.
   TypePtr GetType(TypeId id) const;
 
@@ -48,7 +56,8 @@ class TypeRepository : public base::RefCounted<TypeRepository> {
   // @pre @p type must not be in any repository.
   TypeId AddType(TypePtr type);
 
-  // Add @p type and with @p id if the give id is free.
+  // Add @p type and with @p id if the give id is free. An id is taken if the
+  // snapshot backing this repository holds a type with that id.
   // @pre @p type must not be in any repository and @p id must be free.
   // @returns true on success, failure typically means id is already taken.
   bool AddTypeWithId(TypePtr type, TypeId id);
@@ -57,6 +66,10 @@ class TypeRepository : public base::RefCounted<TypeRepository> {
   // Get the signature for the module this type represents.
   bool GetModuleSignature(pe::PEFile::Signature* signature);
 
+  // @returns the number of types, approximately when some types of the
+  //     snapshot aren't decoded yet. Unlike size(), this doesn't decode them.
+  size_t GetApproximateSize() const;
+
   // @name Accessors.
   // @{
   size_t size() const;
@@ -68,9 +81,20 @@ class TypeRepository : public base::RefCounted<TypeRepository> {
   friend class base::RefCounted<TypeRepository>;
   ~TypeRepository();
 
+  // Decodes the types of snapshot_ that haven't been decoded yet.
+  void DecodeAllTypes() const;
+
   bool is_signature_set_;
   pe::PEFile::Signature signature_;
-  std::unordered_map<TypeId, TypePtr> types_;
+
+  // The types, including those decoded from snapshot_ so far. These are
+  // mutable as decoding happens on retrieval.
+  mutable std::unordered_map<TypeId, TypePtr> types_;
+
+  // The snapshot holding the types of this repository, if any, and whether
+  // all of them have been decoded.
+  scoped_refptr<TypeRepositorySnapshot> snapshot_;
+  mutable bool all_types_decoded_;
 
   DISALLOW_COPY_AND_ASSIGN(TypeRepository);
 };
@@ -115,11 +139,14 @@ class TypeNameIndex : public base::RefCounted<TypeNameIndex> {
   // Retrieve matching @p types by @p name.
   void GetTypes(const base::string16& name, std::vector<TypePtr>* types) const;
 
+  // @returns the number of indexed types.
+  size_t size() const { return name_index_.size(); }
+
  private:
   friend class base::RefCounted<TypeNameIndex>;
   ~TypeNameIndex();
 
-  std::multimap<base::string16, TypePtr> name_index_;
+  std::unordered_multimap<base::string16, TypePtr> name_index_;
 };
 
 }  // namespace refinery
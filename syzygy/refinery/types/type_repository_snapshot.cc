@@ -0,0 +1,611 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/refinery/types/type_repository_snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "base/files/file_util.h"
+#include "base/strings/stringprintf.h"
+#include "syzygy/common/buffer_parser.h"
+#include "syzygy/common/buffer_writer.h"
+#include "syzygy/refinery/types/type_repository.h"
+
+namespace refinery {
+
+namespace {
+
+// The signature and version of snapshots. Bump the version whenever the
+// format of the type records changes.
+const uint32_t kSnapshotSignature = 0x52545A53;  // 'SZTR'.
+const uint32_t kSnapshotVersion = 1;
+
+// The extension of snapshots.
+const char kSnapshotExtension[] = ".types";
+
+// The header of a snapshot. It's followed by the index, then by the type
+// records. Each record is a sequence of aligned uint32_t values and
+// zero-terminated strings, each string padded to a multiple of 4 bytes.
+struct SnapshotHeader {
+  uint32_t signature;
+  uint32_t version;
+  GUID pdb_signature;
+  uint32_t pdb_age;
+  uint32_t type_count;
+};
+
+// Type IDs are stored on 32 bits.
+const uint32_t kNoSnapshotTypeId = static_cast<uint32_t>(-1);
+
+uint32_t ToSnapshotTypeId(TypeId id) {
+  if (id == kNoTypeId)
+    return kNoSnapshotTypeId;
+  DCHECK_GT(kNoSnapshotTypeId, id);
+  return static_cast<uint32_t>(id);
+}
+
+TypeId FromSnapshotTypeId(uint32_t id) {
+  if (id == kNoSnapshotTypeId)
+    return kNoTypeId;
+  return static_cast<TypeId>(id);
+}
+
+Type::Flags GetFlags(bool is_const, bool is_volatile) {
+  return static_cast<Type::Flags>((is_const ? Type::FLAG_CONST : 0) |
+                                  (is_volatile ? Type::FLAG_VOLATILE : 0));
+}
+
+bool WriteUint32(uint32_t value, common::BufferWriter* writer) {
+  DCHECK(writer);
+  return writer->Write(value);
+}
+
+bool WriteName(const base::string16& name, common::BufferWriter* writer) {
+  DCHECK(writer);
+  return writer->WriteString(name) && writer->Align(sizeof(uint32_t));
+}
+
+bool WriteUserDefinedType(const UserDefinedType& udt,
+                          common::BufferWriter* writer) {
+  DCHECK(writer);
+
+  if (!WriteName(udt.GetName(), writer) ||
+      !WriteName(udt.GetDecoratedName(), writer) ||
+      !WriteUint32(udt.udt_kind(), writer) ||
+      !WriteUint32(udt.is_fwd_decl(), writer) ||
+      !WriteUint32(static_cast<uint32_t>(udt.fields().size()), writer)) {
+    return false;
+  }
+
+  for (const auto& field : udt.fields()) {
+    if (!WriteUint32(field->kind(), writer) ||
+        !WriteUint32(static_cast<uint32_t>(field->offset()), writer) ||
+        !WriteUint32(ToSnapshotTypeId(field->type_id()), writer)) {
+      return false;
+    }
+
+    MemberFieldPtr member;
+    if (field->CastTo(&member)) {
+      if (!WriteUint32(GetFlags(member->is_const(), member->is_volatile()),
+                       writer) ||
+          !WriteUint32(static_cast<uint32_t>(member->bit_pos()), writer) ||
+          !WriteUint32(static_cast<uint32_t>(member->bit_len()), writer) ||
+          !WriteName(member->name(), writer)) {
+        return false;
+      }
+    }
+  }
+
+  if (!WriteUint32(static_cast<uint32_t>(udt.functions().size()), writer))
+    return false;
+  for (const auto& function : udt.functions()) {
+    if (!WriteUint32(ToSnapshotTypeId(function.type_id()), writer) ||
+        !WriteName(function.name(), writer)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool WriteFunctionType(const FunctionType& function,
+                       common::BufferWriter* writer) {
+  DCHECK(writer);
+
+  const FunctionType::ArgumentType& return_type = function.return_type();
+  if (!WriteUint32(function.call_convention(), writer) ||
+      !WriteUint32(GetFlags(return_type.is_const(), return_type.is_volatile()),
+                   writer) ||
+      !WriteUint32(ToSnapshotTypeId(return_type.type_id()), writer) ||
+      !WriteUint32(ToSnapshotTypeId(function.containing_class_id()),
+                   writer) ||
+      !WriteUint32(static_cast<uint32_t>(function.argument_types().size()),
+                   writer)) {
+    return false;
+  }
+
+  for (const auto& arg : function.argument_types()) {
+    if (!WriteUint32(GetFlags(arg.is_const(), arg.is_volatile()), writer) ||
+        !WriteUint32(ToSnapshotTypeId(arg.type_id()), writer)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool WriteType(const Type& type, common::BufferWriter* writer) {
+  DCHECK(writer);
+
+  if (!WriteUint32(type.kind(), writer) ||
+      !WriteUint32(static_cast<uint32_t>(type.size()), writer)) {
+    return false;
+  }
+
+  switch (type.kind()) {
+    case Type::BASIC_TYPE_KIND:
+      return WriteName(type.GetName(), writer);
+
+    case Type::USER_DEFINED_TYPE_KIND: {
+      ConstUserDefinedTypePtr udt;
+      return type.CastTo(&udt) && WriteUserDefinedType(*udt, writer);
+    }
+
+    case Type::POINTER_TYPE_KIND: {
+      ConstPointerTypePtr ptr;
+      return type.CastTo(&ptr) &&
+             WriteUint32(ptr->ptr_mode(), writer) &&
+             WriteUint32(GetFlags(ptr->is_const(), ptr->is_volatile()),
+                         writer) &&
+             WriteUint32(ToSnapshotTypeId(ptr->content_type_id()), writer);
+    }
+
+    case Type::ARRAY_TYPE_KIND: {
+      ConstArrayTypePtr array;
+      return type.CastTo(&array) &&
+             WriteUint32(GetFlags(array->is_const(), array->is_volatile()),
+                         writer) &&
+             WriteUint32(ToSnapshotTypeId(array->index_type_id()), writer) &&
+             WriteUint32(static_cast<uint32_t>(array->num_elements()),
+                         writer) &&
+             WriteUint32(ToSnapshotTypeId(array->element_type_id()), writer);
+    }
+
+    case Type::FUNCTION_TYPE_KIND: {
+      ConstFunctionTypePtr function;
+      return type.CastTo(&function) && WriteFunctionType(*function, writer);
+    }
+
+    case Type::GLOBAL_TYPE_KIND: {
+      ConstGlobalTypePtr global;
+      return type.CastTo(&global) &&
+             WriteName(global->GetName(), writer) &&
+             WriteUint32(static_cast<uint32_t>(global->rva()), writer) &&
+             WriteUint32(static_cast<uint32_t>(global->rva() >> 32), writer) &&
+             WriteUint32(ToSnapshotTypeId(global->data_type_id()), writer);
+    }
+
+    case Type::WILDCARD_TYPE_KIND:
+      return WriteName(type.GetName(), writer) &&
+             WriteName(type.GetDecoratedName(), writer);
+  }
+
+  NOTREACHED() << "Unknown type kind " << type.kind() << ".";
+  return false;
+}
+
+// Reads the records written by the functions above.
+class RecordReader {
+ public:
+  RecordReader(const void* data, size_t data_len) : reader_(data, data_len) {}
+
+  bool ReadUint32(uint32_t* value) {
+    DCHECK(value);
+    const uint32_t* data = nullptr;
+    if (!reader_.Read(&data))
+      return false;
+    *value = *data;
+    return true;
+  }
+
+  bool ReadTypeId(TypeId* id) {
+    DCHECK(id);
+    uint32_t value = 0;
+    if (!ReadUint32(&value))
+      return false;
+    *id = FromSnapshotTypeId(value);
+    return true;
+  }
+
+  bool ReadName(base::string16* name) {
+    DCHECK(name);
+    const wchar_t* str = nullptr;
+    size_t str_len = 0;
+    if (!reader_.ReadString(&str, &str_len) ||
+        !reader_.Align(sizeof(uint32_t))) {
+      return false;
+    }
+    name->assign(str, str_len);
+    return true;
+  }
+
+ private:
+  common::BinaryBufferReader reader_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordReader);
+};
+
+TypePtr ReadUserDefinedType(size_t size,
+                            TypeRepository* repository,
+                            RecordReader* reader) {
+  DCHECK(reader);
+
+  base::string16 name;
+  base::string16 decorated_name;
+  uint32_t udt_kind = 0;
+  uint32_t is_fwd_decl = 0;
+  uint32_t field_count = 0;
+  if (!reader->ReadName(&name) || !reader->ReadName(&decorated_name) ||
+      !reader->ReadUint32(&udt_kind) || !reader->ReadUint32(&is_fwd_decl) ||
+      !reader->ReadUint32(&field_count) ||
+      udt_kind > UserDefinedType::UDT_UNION) {
+    return nullptr;
+  }
+
+  UserDefinedType::Fields fields;
+  for (uint32_t i = 0; i < field_count; ++i) {
+    uint32_t kind = 0;
+    uint32_t offset = 0;
+    TypeId type_id = kNoTypeId;
+    if (!reader->ReadUint32(&kind) || !reader->ReadUint32(&offset) ||
+        !reader->ReadTypeId(&type_id)) {
+      return nullptr;
+    }
+
+    ptrdiff_t field_offset = static_cast<int32_t>(offset);
+    switch (kind) {
+      case UserDefinedType::Field::BASE_CLASS_KIND:
+        fields.push_back(new UserDefinedType::BaseClassField(
+            field_offset, type_id, repository));
+        break;
+
+      case UserDefinedType::Field::MEMBER_KIND: {
+        uint32_t flags = 0;
+        uint32_t bit_pos = 0;
+        uint32_t bit_len = 0;
+        base::string16 field_name;
+        if (!reader->ReadUint32(&flags) || !reader->ReadUint32(&bit_pos) ||
+            !reader->ReadUint32(&bit_len) || !reader->ReadName(&field_name) ||
+            bit_pos > 63 || bit_len > 63) {
+          return nullptr;
+        }
+        fields.push_back(new UserDefinedType::MemberField(
+            field_name, field_offset, static_cast<Type::Flags>(flags), bit_pos,
+            bit_len, type_id, repository));
+        break;
+      }
+
+      case UserDefinedType::Field::VFPTR_KIND:
+        fields.push_back(new UserDefinedType::VfptrField(
+            field_offset, type_id, repository));
+        break;
+
+      default:
+        return nullptr;
+    }
+  }
+
+  uint32_t function_count = 0;
+  if (!reader->ReadUint32(&function_count))
+    return nullptr;
+  UserDefinedType::Functions functions;
+  for (uint32_t i = 0; i < function_count; ++i) {
+    TypeId type_id = kNoTypeId;
+    base::string16 function_name;
+    if (!reader->ReadTypeId(&type_id) || !reader->ReadName(&function_name))
+      return nullptr;
+    functions.push_back(UserDefinedType::Function(function_name, type_id));
+  }
+
+  UserDefinedTypePtr udt = new UserDefinedType(
+      name, decorated_name, size,
+      static_cast<UserDefinedType::UdtKind>(udt_kind));
+  if (is_fwd_decl)
+    udt->SetIsForwardDeclaration();
+  else
+    udt->Finalize(&fields, &functions);
+  return udt;
+}
+
+TypePtr ReadFunctionType(RecordReader* reader) {
+  DCHECK(reader);
+
+  uint32_t call_convention = 0;
+  uint32_t return_flags = 0;
+  TypeId return_type_id = kNoTypeId;
+  TypeId containing_class_id = kNoTypeId;
+  uint32_t arg_count = 0;
+  if (!reader->ReadUint32(&call_convention) ||
+      !reader->ReadUint32(&return_flags) ||
+      !reader->ReadTypeId(&return_type_id) ||
+      !reader->ReadTypeId(&containing_class_id) ||
+      !reader->ReadUint32(&arg_count)) {
+    return nullptr;
+  }
+
+  FunctionType::Arguments args;
+  for (uint32_t i = 0; i < arg_count; ++i) {
+    uint32_t flags = 0;
+    TypeId type_id = kNoTypeId;
+    if (!reader->ReadUint32(&flags) || !reader->ReadTypeId(&type_id))
+      return nullptr;
+    args.push_back(
+        FunctionType::ArgumentType(static_cast<Type::Flags>(flags), type_id));
+  }
+
+  FunctionTypePtr function = new FunctionType(
+      static_cast<FunctionType::CallConvention>(call_convention));
+  function->Finalize(
+      FunctionType::ArgumentType(static_cast<Type::Flags>(return_flags),
+                                 return_type_id),
+      args, containing_class_id);
+  return function;
+}
+
+}  // namespace
+
+TypeRepositorySnapshot::TypeRepositorySnapshot()
+    : pdb_age_(0), index_(nullptr), type_count_(0) {
+  ::memset(&pdb_signature_, 0, sizeof(pdb_signature_));
+}
+
+TypeRepositorySnapshot::~TypeRepositorySnapshot() {
+}
+
+base::FilePath TypeRepositorySnapshot::GetPath(const base::FilePath& directory,
+                                               const GUID& pdb_signature,
+                                               uint32_t pdb_age) {
+  std::string name = base::StringPrintf(
+      "%08X%04X%04X", pdb_signature.Data1, pdb_signature.Data2,
+      pdb_signature.Data3);
+  for (size_t i = 0; i < arraysize(pdb_signature.Data4); ++i)
+    base::StringAppendF(&name, "%02X", pdb_signature.Data4[i]);
+  base::StringAppendF(&name, "-%X%s", pdb_age, kSnapshotExtension);
+  return directory.AppendASCII(name);
+}
+
+bool TypeRepositorySnapshot::Write(const TypeRepository& repository,
+                                   const GUID& pdb_signature,
+                                   uint32_t pdb_age,
+                                   const base::FilePath& path) {
+  std::vector<TypePtr> types(repository.begin(), repository.end());
+  std::sort(types.begin(), types.end(),
+            [](const TypePtr& type1, const TypePtr& type2) {
+              return type1->type_id() < type2->type_id();
+            });
+
+  SnapshotHeader header = {};
+  header.signature = kSnapshotSignature;
+  header.version = kSnapshotVersion;
+  header.pdb_signature = pdb_signature;
+  header.pdb_age = pdb_age;
+  header.type_count = static_cast<uint32_t>(types.size());
+
+  // The index is written once the offsets of the records are known.
+  std::vector<uint8_t> data;
+  common::VectorBufferWriter writer(&data);
+  std::vector<IndexEntry> index(types.size());
+  if (!writer.Write(header) ||
+      (!index.empty() && !writer.Write(index.size(), index.data()))) {
+    LOG(ERROR) << "Unable to write type repository snapshot header.";
+    return false;
+  }
+  for (size_t i = 0; i < types.size(); ++i) {
+    index[i].type_id = ToSnapshotTypeId(types[i]->type_id());
+    index[i].offset = static_cast<uint32_t>(writer.pos());
+    if (!WriteType(*types[i], &writer)) {
+      LOG(ERROR) << "Unable to write type " << types[i]->type_id() << ".";
+      return false;
+    }
+  }
+  writer.set_pos(sizeof(header));
+  if (!index.empty() && !writer.Write(index.size(), index.data())) {
+    LOG(ERROR) << "Unable to write type repository snapshot index.";
+    return false;
+  }
+
+  base::FilePath temp_path;
+  if (!base::CreateDirectory(path.DirName()) ||
+      !base::CreateTemporaryFileInDir(path.DirName(), &temp_path)) {
+    LOG(ERROR) << "Unable to create temporary file in: "
+               << path.DirName().value();
+    return false;
+  }
+  base::File::Error error;
+  if (base::WriteFile(temp_path, reinterpret_cast<const char*>(data.data()),
+                      static_cast<int>(data.size())) !=
+          static_cast<int>(data.size()) ||
+      !base::ReplaceFile(temp_path, path, &error)) {
+    LOG(ERROR) << "Unable to write type repository snapshot: "
+               << path.value();
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  return true;
+}
+
+bool TypeRepositorySnapshot::Open(const base::FilePath& path) {
+  DCHECK(!file_.IsValid());
+
+  if (!file_.Initialize(path)) {
+    LOG(ERROR) << "Unable to map type repository snapshot: " << path.value();
+    return false;
+  }
+
+  common::BinaryBufferParser parser(file_.data(), file_.length());
+  const SnapshotHeader* header = nullptr;
+  if (!parser.GetAt(0, &header) ||
+      header->signature != kSnapshotSignature ||
+      header->version != kSnapshotVersion) {
+    LOG(ERROR) << "Invalid type repository snapshot: " << path.value();
+    return false;
+  }
+
+  const IndexEntry* index = nullptr;
+  if (header->type_count > file_.length() / sizeof(IndexEntry) ||
+      (header->type_count != 0 &&
+       !parser.GetCountAt(sizeof(*header), header->type_count, &index))) {
+    LOG(ERROR) << "Invalid type repository snapshot index: " << path.value();
+    return false;
+  }
+
+  // Lookups rely on the index being sorted, and records on being in the
+  // file.
+  for (size_t i = 0; i < header->type_count; ++i) {
+    if ((i > 0 && index[i - 1].type_id >= index[i].type_id) ||
+        index[i].offset >= file_.length()) {
+      LOG(ERROR) << "Invalid type repository snapshot index: "
+                 << path.value();
+      return false;
+    }
+  }
+
+  pdb_signature_ = header->pdb_signature;
+  pdb_age_ = header->pdb_age;
+  index_ = index;
+  type_count_ = header->type_count;
+
+  return true;
+}
+
+bool TypeRepositorySnapshot::HasType(TypeId id) const {
+  return FindIndexEntry(id) != nullptr;
+}
+
+TypePtr TypeRepositorySnapshot::CreateType(TypeId id,
+                                           TypeRepository* repository) const {
+  const IndexEntry* entry = FindIndexEntry(id);
+  if (entry == nullptr)
+    return nullptr;
+
+  RecordReader reader(file_.data() + entry->offset,
+                      file_.length() - entry->offset);
+  uint32_t kind = 0;
+  uint32_t size = 0;
+  if (!reader.ReadUint32(&kind) || !reader.ReadUint32(&size)) {
+    LOG(ERROR) << "Invalid record for type " << id << ".";
+    return nullptr;
+  }
+
+  TypePtr type;
+  base::string16 name;
+  base::string16 decorated_name;
+  switch (kind) {
+    case Type::BASIC_TYPE_KIND:
+      if (reader.ReadName(&name))
+        type = new BasicType(name, size);
+      break;
+
+    case Type::USER_DEFINED_TYPE_KIND:
+      type = ReadUserDefinedType(size, repository, &reader);
+      break;
+
+    case Type::POINTER_TYPE_KIND: {
+      uint32_t ptr_mode = 0;
+      uint32_t flags = 0;
+      TypeId content_type_id = kNoTypeId;
+      if (reader.ReadUint32(&ptr_mode) && reader.ReadUint32(&flags) &&
+          reader.ReadTypeId(&content_type_id) &&
+          ptr_mode <= PointerType::PTR_MODE_REF) {
+        PointerTypePtr ptr =
+            new PointerType(size, static_cast<PointerType::Mode>(ptr_mode));
+        ptr->Finalize(static_cast<Type::Flags>(flags), content_type_id);
+        type = ptr;
+      }
+      break;
+    }
+
+    case Type::ARRAY_TYPE_KIND: {
+      uint32_t flags = 0;
+      TypeId index_type_id = kNoTypeId;
+      uint32_t num_elements = 0;
+      TypeId element_type_id = kNoTypeId;
+      if (reader.ReadUint32(&flags) && reader.ReadTypeId(&index_type_id) &&
+          reader.ReadUint32(&num_elements) &&
+          reader.ReadTypeId(&element_type_id)) {
+        ArrayTypePtr array = new ArrayType(size);
+        array->Finalize(static_cast<Type::Flags>(flags), index_type_id,
+                        num_elements, element_type_id);
+        type = array;
+      }
+      break;
+    }
+
+    case Type::FUNCTION_TYPE_KIND:
+      type = ReadFunctionType(&reader);
+      break;
+
+    case Type::GLOBAL_TYPE_KIND: {
+      uint32_t rva_low = 0;
+      uint32_t rva_high = 0;
+      TypeId data_type_id = kNoTypeId;
+      if (reader.ReadName(&name) && reader.ReadUint32(&rva_low) &&
+          reader.ReadUint32(&rva_high) && reader.ReadTypeId(&data_type_id)) {
+        uint64_t rva = (static_cast<uint64_t>(rva_high) << 32) | rva_low;
+        type = new GlobalType(name, rva, data_type_id, size);
+      }
+      break;
+    }
+
+    case Type::WILDCARD_TYPE_KIND:
+      if (reader.ReadName(&name) && reader.ReadName(&decorated_name))
+        type = new WildcardType(name, decorated_name, size);
+      break;
+  }
+
+  if (!type)
+    LOG(ERROR) << "Invalid record for type " << id << ".";
+  return type;
+}
+
+void TypeRepositorySnapshot::GetTypeIds(std::vector<TypeId>* ids) const {
+  DCHECK(ids);
+
+  ids->clear();
+  ids->reserve(type_count_);
+  for (size_t i = 0; i < type_count_; ++i)
+    ids->push_back(FromSnapshotTypeId(index_[i].type_id));
+}
+
+const TypeRepositorySnapshot::IndexEntry*
+TypeRepositorySnapshot::FindIndexEntry(TypeId id) const {
+  if (id == kNoTypeId || id >= kNoSnapshotTypeId)
+    return nullptr;
+
+  uint32_t snapshot_id = static_cast<uint32_t>(id);
+  const IndexEntry* end = index_ + type_count_;
+  const IndexEntry* entry = std::lower_bound(
+      index_, end, snapshot_id,
+      [](const IndexEntry& entry, uint32_t type_id) {
+        return entry.type_id < type_id;
+      });
+  if (entry == end || entry->type_id != snapshot_id)
+    return nullptr;
+  return entry;
+}
+
+}  // namespace refinery
@@ -0,0 +1,120 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares a serialized form of a type repository. Crawling the types of a
+// PDB is slow, and repeated for every minidump that refers to the module. A
+// snapshot holds the types of a repository in a file that's memory mapped
+// when read back, with an index sorted by type ID. Types are decoded one at
+// a time, as they're requested from a TypeRepository created over the
+// snapshot.
+
+#ifndef SYZYGY_REFINERY_TYPES_TYPE_REPOSITORY_SNAPSHOT_H_
+#define SYZYGY_REFINERY_TYPES_TYPE_REPOSITORY_SNAPSHOT_H_
+
+#include <windows.h>
+#include <stdint.h>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/memory/ref_counted.h"
+#include "syzygy/refinery/types/type.h"
+
+namespace refinery {
+
+// A memory-mapped snapshot of the types of a repository.
+class TypeRepositorySnapshot : public base::RefCounted<TypeRepositorySnapshot> {
+ public:
+  TypeRepositorySnapshot();
+
+  // Computes the path of the snapshot of the types of a PDB in a directory
+  // of snapshots. Snapshots are keyed by the GUID and age of the PDB.
+  // @param directory the directory holding the snapshots.
+  // @param pdb_signature the GUID of the PDB.
+  // @param pdb_age the age of the PDB.
+  // @returns the path of the snapshot.
+  static base::FilePath GetPath(const base::FilePath& directory,
+                                const GUID& pdb_signature,
+                                uint32_t pdb_age);
+
+  // Writes a snapshot of a repository. The snapshot is written to a
+  // temporary file that is then moved into place, so concurrent readers
+  // never see a partial snapshot.
+  // @param repository the repository to write.
+  // @param pdb_signature the GUID of the PDB the types come from.
+  // @param pdb_age the age of the PDB the types come from.
+  // @param path the path of the snapshot.
+  // @returns true on success, false otherwise.
+  static bool Write(const TypeRepository& repository,
+                    const GUID& pdb_signature,
+                    uint32_t pdb_age,
+                    const base::FilePath& path);
+
+  // Opens a snapshot written by Write. Only the header and the index are
+  // checked up front.
+  // @param path the path of the snapshot.
+  // @returns true on success, false if the snapshot can't be read or is
+  //     invalid.
+  bool Open(const base::FilePath& path);
+
+  // @returns true if the snapshot holds a type with ID @p id.
+  bool HasType(TypeId id) const;
+
+  // Decodes a type of the snapshot.
+  // @param id the ID of the type.
+  // @param repository the repository the type's fields refer to.
+  // @returns the type, which isn't yet part of any repository, or nullptr if
+  //     there is no such type or its record is invalid.
+  TypePtr CreateType(TypeId id, TypeRepository* repository) const;
+
+  // Gets the IDs of all the types in the snapshot.
+  // @param ids receives the IDs, in increasing order.
+  void GetTypeIds(std::vector<TypeId>* ids) const;
+
+  // @name Accessors.
+  // @{
+  const GUID& pdb_signature() const { return pdb_signature_; }
+  uint32_t pdb_age() const { return pdb_age_; }
+  size_t size() const { return type_count_; }
+  // @}
+
+ private:
+  friend class base::RefCounted<TypeRepositorySnapshot>;
+  ~TypeRepositorySnapshot();
+
+  // An entry of the index, sorted by type ID.
+  struct IndexEntry {
+    uint32_t type_id;
+    uint32_t offset;
+  };
+
+  // @returns the index entry of the type with ID @p id, or nullptr.
+  const IndexEntry* FindIndexEntry(TypeId id) const;
+
+  base::MemoryMappedFile file_;
+
+  GUID pdb_signature_;
+  uint32_t pdb_age_;
+
+  // The index, in the mapping of the file.
+  const IndexEntry* index_;
+  size_t type_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(TypeRepositorySnapshot);
+};
+
+}  // namespace refinery
+
+#endif  // SYZYGY_REFINERY_TYPES_TYPE_REPOSITORY_SNAPSHOT_H_
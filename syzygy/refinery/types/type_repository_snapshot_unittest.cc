@@ -0,0 +1,207 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/refinery/types/type_repository_snapshot.h"
+
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/refinery/types/pdb_crawler.h"
+#include "syzygy/refinery/types/type.h"
+#include "syzygy/refinery/types/type_repository.h"
+
+namespace refinery {
+
+namespace {
+
+const GUID kPdbSignature = {
+    0x12345678, 0x9ABC, 0xDEF0, {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD,
+                                 0xEF}};
+const uint32_t kPdbAge = 3;
+
+void ExpectSameFields(const UserDefinedType& expected,
+                      const UserDefinedType& actual) {
+  EXPECT_EQ(expected.udt_kind(), actual.udt_kind());
+  EXPECT_EQ(expected.is_fwd_decl(), actual.is_fwd_decl());
+  ASSERT_EQ(expected.fields().size(), actual.fields().size());
+  for (size_t i = 0; i < expected.fields().size(); ++i)
+    EXPECT_TRUE(*expected.fields()[i] == *actual.fields()[i]);
+  EXPECT_EQ(expected.functions(), actual.functions());
+}
+
+void ExpectSameType(const Type& expected, const Type& actual) {
+  ASSERT_EQ(expected.kind(), actual.kind());
+  EXPECT_EQ(expected.type_id(), actual.type_id());
+  EXPECT_EQ(expected.size(), actual.size());
+  EXPECT_EQ(expected.GetName(), actual.GetName());
+  EXPECT_EQ(expected.GetDecoratedName(), actual.GetDecoratedName());
+
+  switch (expected.kind()) {
+    case Type::USER_DEFINED_TYPE_KIND: {
+      ConstUserDefinedTypePtr expected_udt;
+      ConstUserDefinedTypePtr actual_udt;
+      ASSERT_TRUE(expected.CastTo(&expected_udt));
+      ASSERT_TRUE(actual.CastTo(&actual_udt));
+      ExpectSameFields(*expected_udt, *actual_udt);
+      break;
+    }
+
+    case Type::POINTER_TYPE_KIND: {
+      ConstPointerTypePtr expected_ptr;
+      ConstPointerTypePtr actual_ptr;
+      ASSERT_TRUE(expected.CastTo(&expected_ptr));
+      ASSERT_TRUE(actual.CastTo(&actual_ptr));
+      EXPECT_EQ(expected_ptr->ptr_mode(), actual_ptr->ptr_mode());
+      EXPECT_EQ(expected_ptr->is_const(), actual_ptr->is_const());
+      EXPECT_EQ(expected_ptr->is_volatile(), actual_ptr->is_volatile());
+      EXPECT_EQ(expected_ptr->content_type_id(),
+                actual_ptr->content_type_id());
+      break;
+    }
+
+    case Type::ARRAY_TYPE_KIND: {
+      ConstArrayTypePtr expected_array;
+      ConstArrayTypePtr actual_array;
+      ASSERT_TRUE(expected.CastTo(&expected_array));
+      ASSERT_TRUE(actual.CastTo(&actual_array));
+      EXPECT_EQ(expected_array->is_const(), actual_array->is_const());
+      EXPECT_EQ(expected_array->is_volatile(), actual_array->is_volatile());
+      EXPECT_EQ(expected_array->index_type_id(),
+                actual_array->index_type_id());
+      EXPECT_EQ(expected_array->num_elements(), actual_array->num_elements());
+      EXPECT_EQ(expected_array->element_type_id(),
+                actual_array->element_type_id());
+      break;
+    }
+
+    case Type::FUNCTION_TYPE_KIND: {
+      ConstFunctionTypePtr expected_function;
+      ConstFunctionTypePtr actual_function;
+      ASSERT_TRUE(expected.CastTo(&expected_function));
+      ASSERT_TRUE(actual.CastTo(&actual_function));
+      EXPECT_EQ(expected_function->call_convention(),
+                actual_function->call_convention());
+      EXPECT_EQ(expected_function->return_type(),
+                actual_function->return_type());
+      EXPECT_EQ(expected_function->argument_types(),
+                actual_function->argument_types());
+      EXPECT_EQ(expected_function->containing_class_id(),
+                actual_function->containing_class_id());
+      break;
+    }
+
+    case Type::GLOBAL_TYPE_KIND: {
+      ConstGlobalTypePtr expected_global;
+      ConstGlobalTypePtr actual_global;
+      ASSERT_TRUE(expected.CastTo(&expected_global));
+      ASSERT_TRUE(actual.CastTo(&actual_global));
+      EXPECT_EQ(expected_global->rva(), actual_global->rva());
+      EXPECT_EQ(expected_global->data_type_id(),
+                actual_global->data_type_id());
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+class TypeRepositorySnapshotTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    snapshot_path_ = TypeRepositorySnapshot::GetPath(temp_dir_.path(),
+                                                     kPdbSignature, kPdbAge);
+
+    repository_ = new TypeRepository();
+    PdbCrawler crawler;
+    ASSERT_TRUE(crawler.InitializeForFile(testing::GetSrcRelativePath(
+        L"syzygy\\refinery\\test_data\\test_types.dll.pdb")));
+    ASSERT_TRUE(crawler.GetTypes(repository_.get()));
+    ASSERT_LT(0U, repository_->size());
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath snapshot_path_;
+  scoped_refptr<TypeRepository> repository_;
+};
+
+}  // namespace
+
+TEST_F(TypeRepositorySnapshotTest, WriteAndReadBack) {
+  ASSERT_TRUE(TypeRepositorySnapshot::Write(*repository_, kPdbSignature,
+                                            kPdbAge, snapshot_path_));
+
+  scoped_refptr<TypeRepositorySnapshot> snapshot = new TypeRepositorySnapshot();
+  ASSERT_TRUE(snapshot->Open(snapshot_path_));
+  EXPECT_EQ(kPdbSignature, snapshot->pdb_signature());
+  EXPECT_EQ(kPdbAge, snapshot->pdb_age());
+  EXPECT_EQ(repository_->size(), snapshot->size());
+
+  // Types are decoded as they're retrieved.
+  scoped_refptr<TypeRepository> snapshot_repository =
+      new TypeRepository(snapshot);
+  EXPECT_EQ(repository_->size(), snapshot_repository->GetApproximateSize());
+  for (auto type : *repository_) {
+    ASSERT_TRUE(snapshot->HasType(type->type_id()));
+    TypePtr snapshot_type = snapshot_repository->GetType(type->type_id());
+    ASSERT_TRUE(snapshot_type);
+    EXPECT_EQ(snapshot_repository.get(), snapshot_type->repository());
+    ExpectSameType(*type, *snapshot_type);
+
+    // Retrieving a type again yields the same instance.
+    EXPECT_EQ(snapshot_type, snapshot_repository->GetType(type->type_id()));
+  }
+  EXPECT_EQ(repository_->size(), snapshot_repository->size());
+  EXPECT_FALSE(snapshot_repository->GetType(kNoTypeId));
+
+  // The IDs of the snapshot's types are taken.
+  TypePtr type = new BasicType(L"int", 4);
+  EXPECT_FALSE(snapshot_repository->AddTypeWithId(
+      type, (*repository_->begin())->type_id()));
+}
+
+TEST_F(TypeRepositorySnapshotTest, IterateOverSnapshot) {
+  ASSERT_TRUE(TypeRepositorySnapshot::Write(*repository_, kPdbSignature,
+                                            kPdbAge, snapshot_path_));
+
+  scoped_refptr<TypeRepositorySnapshot> snapshot = new TypeRepositorySnapshot();
+  ASSERT_TRUE(snapshot->Open(snapshot_path_));
+  scoped_refptr<TypeRepository> snapshot_repository =
+      new TypeRepository(snapshot);
+
+  // Iteration decodes all the types.
+  size_t type_count = 0;
+  for (auto type : *snapshot_repository) {
+    TypePtr expected_type = repository_->GetType(type->type_id());
+    ASSERT_TRUE(expected_type);
+    ExpectSameType(*expected_type, *type);
+    ++type_count;
+  }
+  EXPECT_EQ(repository_->size(), type_count);
+}
+
+TEST_F(TypeRepositorySnapshotTest, OpenFailsOnInvalidSnapshot) {
+  scoped_refptr<TypeRepositorySnapshot> snapshot = new TypeRepositorySnapshot();
+  EXPECT_FALSE(snapshot->Open(snapshot_path_));
+
+  const char kData[] = "This is not a type repository snapshot.";
+  ASSERT_EQ(static_cast<int>(sizeof(kData)),
+            base::WriteFile(snapshot_path_, kData, sizeof(kData)));
+  snapshot = new TypeRepositorySnapshot();
+  EXPECT_FALSE(snapshot->Open(snapshot_path_));
+}
+
+}  // namespace refinery
@@ -31,12 +31,15 @@
         'type_namer.h',
         'type_repository.cc',
         'type_repository.h',
+        'type_repository_snapshot.cc',
+        'type_repository_snapshot.h',
         'typed_data.cc',
         'typed_data.h',
       ],
       'dependencies': [
         'test_typenames',
         'test_types',
+        '<(src)/syzygy/common/common.gyp:common_lib',
         '<(src)/syzygy/pe/pe.gyp:dia_sdk',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/refinery/core/core.gyp:refinery_core_lib',
@@ -17,6 +17,7 @@
 #include <string>
 
 #include "base/strings/stringprintf.h"
+#include "syzygy/refinery/process_state/caching_bit_source.h"
 #include "syzygy/refinery/process_state/process_state_util.h"
 #include "syzygy/refinery/process_state/refinery.pb.h"
 #include "syzygy/refinery/types/type.h"
@@ -91,14 +92,16 @@ Validator::ValidationResult VftablePtrValidator::Validate(
     return VALIDATION_ERROR;
   }
 
-  // Validate each typed block.
+  // Validate each typed block. The validation reads the bytes layer in many
+  // small pieces.
   ModuleLayerAccessor accessor(process_state);
+  CachingBitSource bit_source(process_state);
   for (TypedBlockRecordPtr rec : *typed_layer) {
     TypePtr type = RecoverType(&accessor, symbol_provider_.get(), rec->data());
     if (type == nullptr)
       return VALIDATION_ERROR;
 
-    TypedData typed_data(process_state, type, rec->range().start());
+    TypedData typed_data(&bit_source, type, rec->range().start());
     ValidateTypedData(typed_data, vftable_vas, report);
   }
 
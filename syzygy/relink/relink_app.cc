@@ -18,6 +18,7 @@
 #include "syzygy/block_graph/orderers/original_orderer.h"
 #include "syzygy/block_graph/orderers/random_orderer.h"
 #include "syzygy/block_graph/transforms/fuzzing_transform.h"
+#include "syzygy/core/phase_profiler.h"
 #include "syzygy/pe/pe_relinker.h"
 #include "syzygy/pe/transforms/explode_basic_blocks_transform.h"
 #include "syzygy/reorder/orderers/explicit_orderer.h"
@@ -43,6 +44,8 @@ const char kUsageFormatStr[] =
     "    --exclude-bb-padding  When randomly reordering basic blocks, exclude\n"
     "                          padding and unreachable code from the relinked\n"
     "                          output binary.\n"
+    "    --incremental-pdb     Write the output PDB by updating a copy of the\n"
+    "                          input PDB, rather than rewriting every stream.\n"
     "    --input-pdb=<path>    The PDB file associated with the input DLL.\n"
     "                          Default is inferred from input-image.\n"
     "    --no-augment-pdb      Indicates that the relinker should not augment\n"
@@ -57,6 +60,9 @@ const char kUsageFormatStr[] =
     "                          Default is inferred from output-image.\n"
     "    --overwrite           Allow output files to be overwritten.\n"
     "    --padding=<integer>   Add bytes of padding between blocks.\n"
+    "    --phase-profile=<path>\n"
+    "                          Write the time and memory taken by each phase\n"
+    "                          of the relink to a JSON file.\n"
     "    --verbose             Log verbosely.\n"
     "\n"
     "  Testing Options:\n"
@@ -122,8 +128,10 @@ bool RelinkApp::ParseCommandLine(const base::CommandLine* cmd_line) {
 
   output_pdb_path_ = cmd_line->GetSwitchValuePath("output-pdb");
   order_file_path_ = AbsolutePath(cmd_line->GetSwitchValuePath("order-file"));
+  phase_profile_path_ = cmd_line->GetSwitchValuePath("phase-profile");
   no_augment_pdb_ = cmd_line->HasSwitch("no-augment-pdb");
   compress_pdb_ = cmd_line->HasSwitch("compress-pdb");
+  incremental_pdb_ = cmd_line->HasSwitch("incremental-pdb");
   no_strip_strings_ = cmd_line->HasSwitch("no-strip-strings");
   output_metadata_ = !cmd_line->HasSwitch("no-metadata");
   overwrite_ = cmd_line->HasSwitch("overwrite");
@@ -196,6 +204,12 @@ bool RelinkApp::SetUp() {
 }
 
 int RelinkApp::Run() {
+  // Profile the phases of the relink if asked to.
+  core::PhaseProfiler profiler;
+  std::unique_ptr<core::PhaseProfiler::ScopedCurrent> scoped_profiler;
+  if (!phase_profile_path_.empty())
+    scoped_profiler.reset(new core::PhaseProfiler::ScopedCurrent(&profiler));
+
   pe::PETransformPolicy policy;
   pe::PERelinker relinker(&policy);
   relinker.set_input_path(input_image_path_);
@@ -208,6 +222,7 @@ int RelinkApp::Run() {
   relinker.set_allow_overwrite(overwrite_);
   relinker.set_augment_pdb(!no_augment_pdb_);
   relinker.set_compress_pdb(compress_pdb_);
+  relinker.set_incremental_pdb(incremental_pdb_);
   relinker.set_strip_strings(!no_strip_strings_);
 
   // Initialize the relinker. This does the decomposition, etc.
@@ -234,9 +249,9 @@ int RelinkApp::Run() {
 
   // If an order file is provided we are performing an explicit ordering.
   if (!order_file_path_.empty()) {
-    if (!order.LoadFromJSON(relinker.input_pe_file(),
-                            relinker.input_image_layout(),
-                            order_file_path_)) {
+    if (!order.Load(relinker.input_pe_file(),
+                    relinker.input_image_layout(),
+                    order_file_path_)) {
       LOG(ERROR) << "Failed to load order file: " << order_file_path_.value();
       return 1;
     }
@@ -281,6 +296,11 @@ int RelinkApp::Run() {
     return 1;
   }
 
+  if (!phase_profile_path_.empty() &&
+      !profiler.SaveToJSON(phase_profile_path_, true)) {
+    return 1;
+  }
+
   return 0;
 }
 
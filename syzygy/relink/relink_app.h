@@ -35,6 +35,7 @@ class RelinkApp : public application::AppImplBase {
         code_alignment_(1),
         no_augment_pdb_(false),
         compress_pdb_(false),
+        incremental_pdb_(false),
         no_strip_strings_(false),
         output_metadata_(false),
         overwrite_(false),
@@ -64,11 +65,13 @@ class RelinkApp : public application::AppImplBase {
   base::FilePath output_image_path_;
   base::FilePath output_pdb_path_;
   base::FilePath order_file_path_;
+  base::FilePath phase_profile_path_;
   uint32_t seed_;
   size_t padding_;
   size_t code_alignment_;
   bool no_augment_pdb_;
   bool compress_pdb_;
+  bool incremental_pdb_;
   bool no_strip_strings_;
   bool output_metadata_;
   bool overwrite_;
@@ -14,6 +14,7 @@
 
 #include "syzygy/relink/relink_app.h"
 
+#include "base/files/file_util.h"
 #include "base/strings/stringprintf.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -43,11 +44,13 @@ class TestRelinkApp : public RelinkApp {
   using RelinkApp::output_image_path_;
   using RelinkApp::output_pdb_path_;
   using RelinkApp::order_file_path_;
+  using RelinkApp::phase_profile_path_;
   using RelinkApp::seed_;
   using RelinkApp::padding_;
   using RelinkApp::code_alignment_;
   using RelinkApp::no_augment_pdb_;
   using RelinkApp::compress_pdb_;
+  using RelinkApp::incremental_pdb_;
   using RelinkApp::no_strip_strings_;
   using RelinkApp::output_metadata_;
   using RelinkApp::overwrite_;
@@ -237,6 +240,7 @@ TEST_F(RelinkAppTest, ParseMinimalCommandLineWithOrderFile) {
   EXPECT_EQ(1, test_impl_.code_alignment_);
   EXPECT_FALSE(test_impl_.no_augment_pdb_);
   EXPECT_FALSE(test_impl_.compress_pdb_);
+  EXPECT_FALSE(test_impl_.incremental_pdb_);
   EXPECT_FALSE(test_impl_.no_strip_strings_);
   EXPECT_TRUE(test_impl_.output_metadata_);
   EXPECT_FALSE(test_impl_.overwrite_);
@@ -254,6 +258,7 @@ TEST_F(RelinkAppTest, ParseFullCommandLineWithOrderFile) {
   cmd_line_.AppendSwitchPath("order-file", order_file_path_);
   cmd_line_.AppendSwitch("no-augment-pdb");
   cmd_line_.AppendSwitch("compress-pdb");
+  cmd_line_.AppendSwitch("incremental-pdb");
   cmd_line_.AppendSwitch("no-strip-strings");
   cmd_line_.AppendSwitch("no-metadata");
   cmd_line_.AppendSwitch("overwrite");
@@ -270,6 +275,7 @@ TEST_F(RelinkAppTest, ParseFullCommandLineWithOrderFile) {
   EXPECT_EQ(1, test_impl_.code_alignment_);
   EXPECT_TRUE(test_impl_.no_augment_pdb_);
   EXPECT_TRUE(test_impl_.compress_pdb_);
+  EXPECT_TRUE(test_impl_.incremental_pdb_);
   EXPECT_TRUE(test_impl_.no_strip_strings_);
   EXPECT_FALSE(test_impl_.output_metadata_);
   EXPECT_TRUE(test_impl_.overwrite_);
@@ -353,6 +359,28 @@ TEST_F(RelinkAppTest, RandomRelink) {
   ASSERT_NO_FATAL_FAILURE(CheckTestDll(output_image_path_));
 }
 
+TEST_F(RelinkAppTest, RandomRelinkWithPhaseProfile) {
+  base::FilePath phase_profile_path(temp_dir_.Append(L"profile.json"));
+  cmd_line_.AppendSwitchPath("input-image", input_image_path_);
+  cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
+  cmd_line_.AppendSwitchPath("output-image", output_image_path_);
+  cmd_line_.AppendSwitchPath("output-pdb", output_pdb_path_);
+  cmd_line_.AppendSwitchPath("phase-profile", phase_profile_path);
+  cmd_line_.AppendSwitchASCII("seed", base::StringPrintf("%d", seed_));
+  cmd_line_.AppendSwitch("overwrite");
+
+  ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(phase_profile_path, test_impl_.phase_profile_path_);
+
+  ASSERT_EQ(0, test_app_.Run());
+  ASSERT_NO_FATAL_FAILURE(CheckTestDll(output_image_path_));
+
+  std::string profile;
+  ASSERT_TRUE(base::ReadFileToString(phase_profile_path, &profile));
+  EXPECT_NE(std::string::npos, profile.find("\"decompose\""));
+  EXPECT_NE(std::string::npos, profile.find("\"write_pdb\""));
+}
+
 TEST_F(RelinkAppTest, RandomRelinkBasicBlocks) {
   cmd_line_.AppendSwitchPath("input-image", input_image_path_);
   cmd_line_.AppendSwitchPath("input-pdb", input_pdb_path_);
@@ -14,21 +14,68 @@
 
 #include "syzygy/reorder/dead_code_finder.h"
 
+#include <utility>
+#include <vector>
+
+#include "base/values.h"
+#include "base/files/file_util.h"
+#include "base/json/json_reader.h"
+#include "syzygy/core/json_file_writer.h"
+#include "syzygy/pe/metadata.h"
+#include "syzygy/pe/pe_utils.h"
+
 namespace reorder {
 
+namespace {
+
+using base::DictionaryValue;
+using base::ListValue;
+using base::Value;
+
+// Database JSON keys.
+const char kMetadataKey[] = "metadata";
+const char kRunCountKey[] = "run_count";
+const char kBlocksKey[] = "blocks";
+
+}  // namespace
+
 DeadCodeFinder::DeadCodeFinder()
-    : Reorderer::OrderGenerator("Dead Code Finder") {
+    : Reorderer::OrderGenerator("Dead Code Finder"),
+      run_count_(0),
+      min_live_runs_(1) {
 }
 
 DeadCodeFinder::~DeadCodeFinder() {
 }
 
+bool DeadCodeFinder::OnProcessStarted(uint32_t process_id,
+                                      const UniqueTime& /*time*/) {
+  StartRun(process_id);
+  return true;
+}
+
 bool DeadCodeFinder::OnCodeBlockEntry(const Block* block,
                                       RelativeAddress /*address*/,
-                                      uint32_t /*process_id*/,
+                                      uint32_t process_id,
                                       uint32_t /*thread_id*/,
                                       const UniqueTime& /*time*/) {
-  visited_blocks_.insert(block);
+  DCHECK(block != NULL);
+
+  // Processes whose trace misses the start event get a run of their own.
+  size_t run = 0;
+  std::map<uint32_t, size_t>::const_iterator it =
+      process_runs_.find(process_id);
+  if (it == process_runs_.end())
+    run = StartRun(process_id);
+  else
+    run = it->second;
+
+  // Count each run once per block.
+  BlockRuns& runs = visited_blocks_[block];
+  if (runs.last_run != run + 1) {
+    ++runs.run_count;
+    runs.last_run = run + 1;
+  }
   return true;
 }
 
@@ -38,7 +85,138 @@ bool DeadCodeFinder::IsDead(const Block* block) const {
   // just being noise (not easily actionable) for the consumer of the dead code
   // finder's output.
   return ((block->attributes() & BlockGraph::GAP_BLOCK) == 0)
-      && (visited_blocks_.find(block) == visited_blocks_.end());
+      && (GetRunCount(block) < min_live_runs_);
+}
+
+size_t DeadCodeFinder::GetRunCount(const Block* block) const {
+  BlockRunsMap::const_iterator it = visited_blocks_.find(block);
+  if (it == visited_blocks_.end())
+    return 0;
+  return it->second.run_count;
+}
+
+bool DeadCodeFinder::LoadDatabase(const base::FilePath& path,
+                                  const PEFile& pe_file,
+                                  const ImageLayout& image) {
+  std::string file_string;
+  if (!base::ReadFileToString(path, &file_string)) {
+    LOG(ERROR) << "Unable to read dead code database: " << path.value();
+    return false;
+  }
+
+  const DictionaryValue* dict = NULL;
+  std::unique_ptr<Value> value(base::JSONReader::Read(file_string).release());
+  if (value.get() == NULL || !value->GetAsDictionary(&dict)) {
+    LOG(ERROR) << "Dead code database does not contain a valid JSON "
+               << "dictionary.";
+    return false;
+  }
+
+  const DictionaryValue* metadata_dict = NULL;
+  pe::Metadata metadata;
+  if (!dict->GetDictionary(kMetadataKey, &metadata_dict) ||
+      !metadata.LoadFromJSON(*metadata_dict)) {
+    LOG(ERROR) << "Missing or invalid " << kMetadataKey << ".";
+    return false;
+  }
+
+  // The run counts are keyed by address, so they're meaningless for any
+  // other build of the module.
+  PEFile::Signature signature;
+  pe_file.GetSignature(&signature);
+  if (!signature.IsConsistent(metadata.module_signature())) {
+    LOG(WARNING) << "Ignoring dead code database of another module: "
+                 << path.value();
+    return true;
+  }
+
+  int run_count = 0;
+  const ListValue* blocks = NULL;
+  if (!dict->GetInteger(kRunCountKey, &run_count) || run_count < 0 ||
+      !dict->GetList(kBlocksKey, &blocks)) {
+    LOG(ERROR) << "Missing or invalid " << kRunCountKey << " or "
+               << kBlocksKey << ".";
+    return false;
+  }
+
+  // Read all the [address, run count] pairs before merging any of them.
+  std::vector<std::pair<const Block*, size_t>> block_runs;
+  for (size_t i = 0; i < blocks->GetSize(); ++i) {
+    const ListValue* entry = NULL;
+    int address = 0;
+    int runs = 0;
+    if (!blocks->GetList(i, &entry) || entry->GetSize() != 2 ||
+        !entry->GetInteger(0, &address) || !entry->GetInteger(1, &runs) ||
+        runs <= 0 || runs > run_count) {
+      LOG(ERROR) << "Invalid entry " << i << " of " << kBlocksKey << ".";
+      return false;
+    }
+
+    RelativeAddress addr(address);
+    const Block* block = image.blocks.GetBlockByAddress(addr);
+    if (block == NULL || block->addr() != addr) {
+      LOG(ERROR) << "No block starts at " << addr << ".";
+      return false;
+    }
+    block_runs.push_back(std::make_pair(block, runs));
+  }
+
+  for (size_t i = 0; i < block_runs.size(); ++i)
+    visited_blocks_[block_runs[i].first].run_count += block_runs[i].second;
+  run_count_ += run_count;
+
+  LOG(INFO) << "Merged " << run_count << " runs from dead code database.";
+  return true;
+}
+
+bool DeadCodeFinder::SaveDatabase(const base::FilePath& path,
+                                  const PEFile& pe_file) const {
+  PEFile::Signature signature;
+  pe_file.GetSignature(&signature);
+  pe::Metadata metadata;
+  if (!metadata.Init(signature))
+    return false;
+
+  // Output the blocks by address, so that the database is deterministic.
+  std::map<RelativeAddress, size_t> block_runs;
+  BlockRunsMap::const_iterator it = visited_blocks_.begin();
+  for (; it != visited_blocks_.end(); ++it) {
+    if (it->second.run_count != 0)
+      block_runs[it->first->addr()] = it->second.run_count;
+  }
+
+  base::ScopedFILE file(base::OpenFile(path, "wb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to open dead code database: " << path.value();
+    return false;
+  }
+  core::JSONFileWriter json_file(file.get(), false);
+  if (!json_file.OpenDict() ||
+      !json_file.OutputKey(kMetadataKey) ||
+      !metadata.SaveToJSON(&json_file) ||
+      !json_file.OutputKey(kRunCountKey) ||
+      !json_file.OutputInteger(run_count_) ||
+      !json_file.OutputKey(kBlocksKey) ||
+      !json_file.OpenList()) {
+    return false;
+  }
+
+  std::map<RelativeAddress, size_t>::const_iterator runs_it =
+      block_runs.begin();
+  for (; runs_it != block_runs.end(); ++runs_it) {
+    if (!json_file.OpenList() ||
+        !json_file.OutputInteger(runs_it->first.value()) ||
+        !json_file.OutputInteger(runs_it->second) ||
+        !json_file.CloseList()) {
+      return false;
+    }
+  }
+
+  if (!json_file.CloseList() || !json_file.CloseDict())
+    return false;
+
+  DCHECK(json_file.Finished());
+  return true;
 }
 
 bool DeadCodeFinder::CalculateReordering(const PEFile& pe_file,
@@ -48,7 +226,21 @@ bool DeadCodeFinder::CalculateReordering(const PEFile& pe_file,
                                          Order* order) {
   DCHECK(order != NULL);
 
-  order->comment = "Unvisited blocks per section";
+  // Merge the runs of previous invocations.
+  if (!database_path_.empty() && base::PathExists(database_path_) &&
+      !LoadDatabase(database_path_, pe_file, image)) {
+    return false;
+  }
+
+  LOG(INFO) << "Encountered " << run_count_ << " runs.";
+
+  bool cold_placement = !cold_section_name_.empty();
+  Order::BlockSpecVector cold_blocks;
+
+  if (cold_placement)
+    order->comment = "Dead code blocks moved to " + cold_section_name_;
+  else
+    order->comment = "Unvisited blocks per section";
   order->sections.clear();
   order->sections.resize(image.sections.size());
   for (size_t i = 0; i < image.sections.size(); ++i) {
@@ -56,7 +248,8 @@ bool DeadCodeFinder::CalculateReordering(const PEFile& pe_file,
     order->sections[i].id = i;
     order->sections[i].name = section.name;
     order->sections[i].characteristics = section.characteristics;
-    if ((section.characteristics & IMAGE_SCN_CNT_CODE) == 0)
+    bool is_code = (section.characteristics & IMAGE_SCN_CNT_CODE) != 0;
+    if (!is_code && !cold_placement)
       continue;
 
     // Prepare to iterate over all block in the section.
@@ -65,19 +258,48 @@ bool DeadCodeFinder::CalculateReordering(const PEFile& pe_file,
         image.blocks.GetIntersectingBlocks(
             section_range.start(), section_range.size()));
 
-    // Gather up all unvisited blocks within the section in the "order".
+    // Gather up all unvisited blocks within the section in the "order". When
+    // placing the dead code in the cold section, the section keeps the other
+    // blocks in their original order instead.
     AddressSpace::RangeMapConstIter& section_it = section_blocks.first;
     const AddressSpace::RangeMapConstIter& section_end = section_blocks.second;
     Order::BlockSpecVector& block_vector = order->sections[i].blocks;
     for (; section_it != section_end; ++section_it) {
       const BlockGraph::Block* block = section_it->second;
-      if (IsDead(block)) {
+      bool is_dead = is_code && IsDead(block);
+      if (!cold_placement) {
+        if (is_dead)
+          block_vector.push_back(Order::BlockSpec(block));
+      } else if (is_dead && reorder_code &&
+                 block->type() == BlockGraph::CODE_BLOCK) {
+        cold_blocks.push_back(Order::BlockSpec(block));
+      } else {
         block_vector.push_back(Order::BlockSpec(block));
       }
     }
   }
 
+  // The relinker creates the cold section, which mustn't be empty.
+  if (!cold_blocks.empty()) {
+    order->sections.push_back(Order::SectionSpec());
+    Order::SectionSpec& cold_section = order->sections.back();
+    cold_section.id = Order::SectionSpec::kNewSectionId;
+    cold_section.name = cold_section_name_;
+    cold_section.characteristics = pe::kCodeCharacteristics;
+    cold_section.blocks.swap(cold_blocks);
+  }
+
+  // Accumulate the runs for the next invocations.
+  if (!database_path_.empty() && !SaveDatabase(database_path_, pe_file))
+    return false;
+
   return true;
 }
 
+size_t DeadCodeFinder::StartRun(uint32_t process_id) {
+  size_t run = run_count_++;
+  process_runs_[process_id] = run;
+  return run;
+}
+
 }  // namespace reorder
@@ -15,13 +15,26 @@
 #ifndef SYZYGY_REORDER_DEAD_CODE_FINDER_H_
 #define SYZYGY_REORDER_DEAD_CODE_FINDER_H_
 
-#include <set>
+#include <map>
+#include <string>
 
+#include "base/files/file_path.h"
 #include "syzygy/reorder/reorderer.h"
 
 namespace reorder {
 
 // Identifies code symbols which are not referenced by a given call trace.
+//
+// Each process seen in the call trace counts as a run, and the finder keeps
+// the number of runs each block was visited in. A block is dead if it was
+// visited in fewer than min_live_runs() runs, and the number of runs it was
+// visited in is a measure of the confidence in that verdict.
+//
+// The run counts can be accumulated across invocations in a database file,
+// which is only valid for the module signature it was built against. The
+// finder either lists the dead blocks of each code section or, given a cold
+// section name, outputs a complete ordering moving the dead code blocks to a
+// new section of that name, ready to be fed to the relinker.
 class DeadCodeFinder : public Reorderer::OrderGenerator {
  public:
   typedef BlockGraph::Block Block;
@@ -32,8 +45,53 @@ class DeadCodeFinder : public Reorderer::OrderGenerator {
   // Returns true if the block is of interest and unvisited.
   bool IsDead(const Block* block) const;
 
+  // @returns the number of runs @p block was visited in.
+  size_t GetRunCount(const Block* block) const;
+
+  // Merges the run counts of a database into this finder.
+  // @param path the path of the database.
+  // @param pe_file the module the run counts refer to.
+  // @param image the layout of the module.
+  // @returns true on success, false otherwise. A database built against
+  //     another module signature is ignored, with a warning.
+  bool LoadDatabase(const base::FilePath& path,
+                    const PEFile& pe_file,
+                    const ImageLayout& image);
+
+  // Saves the run counts of this finder to a database.
+  // @param path the path of the database.
+  // @param pe_file the module the run counts refer to.
+  // @returns true on success, false otherwise.
+  bool SaveDatabase(const base::FilePath& path, const PEFile& pe_file) const;
+
+  // @name Accessors and mutators.
+  // @{
+  // The number of runs seen so far, including those of the database.
+  size_t run_count() const { return run_count_; }
+  // The number of runs a block must be visited in to be live. Defaults to 1.
+  size_t min_live_runs() const { return min_live_runs_; }
+  void set_min_live_runs(size_t min_live_runs) {
+    DCHECK_LT(0U, min_live_runs);
+    min_live_runs_ = min_live_runs;
+  }
+  // The database merged before, and updated after, calculating the order.
+  // Empty by default, in which case no database is used.
+  const base::FilePath& database_path() const { return database_path_; }
+  void set_database_path(const base::FilePath& database_path) {
+    database_path_ = database_path;
+  }
+  // The name of the section receiving the dead code blocks. Empty by
+  // default, in which case only the dead blocks are listed.
+  const std::string& cold_section_name() const { return cold_section_name_; }
+  void set_cold_section_name(const std::string& cold_section_name) {
+    cold_section_name_ = cold_section_name;
+  }
+  // @}
+
   // OrderGenerator implementation.
   // @{
+  virtual bool OnProcessStarted(uint32_t process_id,
+                                const UniqueTime& time) override;
   virtual bool OnCodeBlockEntry(const Block* block,
                                 RelativeAddress address,
                                 uint32_t process_id,
@@ -47,8 +105,31 @@ class DeadCodeFinder : public Reorderer::OrderGenerator {
   // @}
 
  protected:
-  // The set of blocks observed while reading the call trace.
-  std::set<const Block*> visited_blocks_;
+  // The runs a block was visited in.
+  struct BlockRuns {
+    BlockRuns() : run_count(0), last_run(0) {}
+
+    size_t run_count;
+    // The index of the last run counted in run_count, plus one.
+    size_t last_run;
+  };
+  typedef std::map<const Block*, BlockRuns> BlockRunsMap;
+
+  // Starts a new run for a process.
+  // @param process_id the id of the process.
+  // @returns the index of the run.
+  size_t StartRun(uint32_t process_id);
+
+  // The blocks observed while reading the call trace, and their runs.
+  BlockRunsMap visited_blocks_;
+
+  // The current run of each process.
+  std::map<uint32_t, size_t> process_runs_;
+
+  size_t run_count_;
+  size_t min_live_runs_;
+  base::FilePath database_path_;
+  std::string cold_section_name_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(DeadCodeFinder);
@@ -14,10 +14,12 @@
 
 #include "syzygy/reorder/dead_code_finder.h"
 
+#include "base/files/file_util.h"
 #include "gtest/gtest.h"
 #include "syzygy/block_graph/block_graph.h"
 #include "syzygy/core/address.h"
 #include "syzygy/core/random_number_generator.h"
+#include "syzygy/pe/pe_utils.h"
 #include "syzygy/reorder/order_generator_test.h"
 
 namespace reorder {
@@ -30,6 +32,31 @@ class DeadCodeFinderTest : public testing::OrderGeneratorTest {
   DeadCodeFinderTest() : random_(12345) {
   }
 
+  // Returns a random block of the .text section which isn't a gap block.
+  const block_graph::BlockGraph::Block* GetRandomTextBlock() {
+    const IMAGE_SECTION_HEADER* section =
+        input_dll_.section_header(input_dll_.GetSectionIndex(".text"));
+    DCHECK(section != NULL);
+    while (true) {
+      core::RelativeAddress addr(
+          section->VirtualAddress + random_(section->Misc.VirtualSize));
+      const block_graph::BlockGraph::Block* block =
+          image_layout_.blocks.GetBlockByAddress(addr);
+      if ((block->attributes() & block_graph::BlockGraph::GAP_BLOCK) == 0)
+        return block;
+    }
+  }
+
+  // Visits blocks in a run of their own.
+  void VisitInRun(uint32_t process_id, const BlockSet& blocks) {
+    dead_code_finder_.OnProcessStarted(process_id, GetSystemTime());
+    for (BlockIter it = blocks.begin(); it != blocks.end(); ++it) {
+      dead_code_finder_.OnCodeBlockEntry(
+          *it, (*it)->addr(), process_id, 1, GetSystemTime());
+    }
+    dead_code_finder_.OnProcessEnded(process_id, GetSystemTime());
+  }
+
   DeadCodeFinder dead_code_finder_;
   BlockSet live_blocks_;
   BlockSet dead_blocks_;
@@ -118,4 +145,112 @@ TEST_F(DeadCodeFinderTest, TestDLL) {
   }
 }
 
+TEST_F(DeadCodeFinderTest, RunCounts) {
+  const block_graph::BlockGraph::Block* block1 = GetRandomTextBlock();
+  const block_graph::BlockGraph::Block* block2 = block1;
+  while (block2 == block1)
+    block2 = GetRandomTextBlock();
+
+  // The first block is visited twice by each of two runs, the second block
+  // once by the first run.
+  live_blocks_.insert(block1);
+  live_blocks_.insert(block2);
+  VisitInRun(1, live_blocks_);
+  dead_code_finder_.OnCodeBlockEntry(block1, block1->addr(), 1, 1,
+                                     GetSystemTime());
+  live_blocks_.erase(block2);
+  VisitInRun(2, live_blocks_);
+  dead_code_finder_.OnCodeBlockEntry(block1, block1->addr(), 2, 1,
+                                     GetSystemTime());
+
+  EXPECT_EQ(2U, dead_code_finder_.run_count());
+  EXPECT_EQ(2U, dead_code_finder_.GetRunCount(block1));
+  EXPECT_EQ(1U, dead_code_finder_.GetRunCount(block2));
+  EXPECT_FALSE(dead_code_finder_.IsDead(block2));
+
+  // Blocks visited in fewer runs than required are dead.
+  dead_code_finder_.set_min_live_runs(2);
+  EXPECT_FALSE(dead_code_finder_.IsDead(block1));
+  EXPECT_TRUE(dead_code_finder_.IsDead(block2));
+}
+
+TEST_F(DeadCodeFinderTest, DatabaseAccumulatesRuns) {
+  base::FilePath temp_dir;
+  CreateTemporaryDir(&temp_dir);
+  base::FilePath database_path = temp_dir.Append(L"dead_code.json");
+
+  const block_graph::BlockGraph::Block* block1 = GetRandomTextBlock();
+  const block_graph::BlockGraph::Block* block2 = block1;
+  while (block2 == block1)
+    block2 = GetRandomTextBlock();
+
+  // A first invocation visits the first block.
+  live_blocks_.insert(block1);
+  dead_code_finder_.set_database_path(database_path);
+  VisitInRun(1, live_blocks_);
+  ASSERT_TRUE(dead_code_finder_.CalculateReordering(input_dll_,
+                                                    image_layout_,
+                                                    true,
+                                                    false,
+                                                    &order_));
+  ASSERT_TRUE(base::PathExists(database_path));
+
+  // A second invocation visits the second block in two runs, and merges the
+  // run of the first invocation.
+  DeadCodeFinder dead_code_finder;
+  dead_code_finder.set_database_path(database_path);
+  for (uint32_t process_id = 1; process_id <= 2; ++process_id) {
+    dead_code_finder.OnProcessStarted(process_id, GetSystemTime());
+    dead_code_finder.OnCodeBlockEntry(block2, block2->addr(), process_id, 1,
+                                      GetSystemTime());
+  }
+  ASSERT_TRUE(dead_code_finder.CalculateReordering(input_dll_,
+                                                   image_layout_,
+                                                   true,
+                                                   false,
+                                                   &order_));
+
+  EXPECT_EQ(3U, dead_code_finder.run_count());
+  EXPECT_EQ(1U, dead_code_finder.GetRunCount(block1));
+  EXPECT_EQ(2U, dead_code_finder.GetRunCount(block2));
+  EXPECT_FALSE(dead_code_finder.IsDead(block1));
+
+  // The database now holds all three runs.
+  DeadCodeFinder loaded_finder;
+  ASSERT_TRUE(loaded_finder.LoadDatabase(database_path, input_dll_,
+                                         image_layout_));
+  EXPECT_EQ(3U, loaded_finder.run_count());
+  EXPECT_EQ(1U, loaded_finder.GetRunCount(block1));
+  EXPECT_EQ(2U, loaded_finder.GetRunCount(block2));
+}
+
+TEST_F(DeadCodeFinderTest, ColdSection) {
+  const char kColdSectionName[] = ".cold";
+  while (live_blocks_.size() < 20)
+    live_blocks_.insert(GetRandomTextBlock());
+  VisitInRun(1, live_blocks_);
+
+  dead_code_finder_.set_cold_section_name(kColdSectionName);
+  ASSERT_TRUE(dead_code_finder_.CalculateReordering(input_dll_,
+                                                    image_layout_,
+                                                    true,
+                                                    false,
+                                                    &order_));
+
+  ExpectNoDuplicateBlocks();
+
+  // The dead code blocks are moved to a new cold section.
+  ASSERT_EQ(image_layout_.sections.size() + 1, order_.sections.size());
+  const SectionSpec& cold_section = order_.sections.back();
+  EXPECT_EQ(SectionSpec::kNewSectionId, cold_section.id);
+  EXPECT_EQ(kColdSectionName, cold_section.name);
+  EXPECT_EQ(pe::kCodeCharacteristics, cold_section.characteristics);
+  ASSERT_FALSE(cold_section.blocks.empty());
+  for (size_t i = 0; i < cold_section.blocks.size(); ++i) {
+    const block_graph::BlockGraph::Block* block = cold_section.blocks[i].block;
+    EXPECT_EQ(block_graph::BlockGraph::CODE_BLOCK, block->type());
+    EXPECT_TRUE(dead_code_finder_.IsDead(block));
+  }
+}
+
 }  // namespace reorder
@@ -16,6 +16,10 @@
 
 #include <algorithm>
 
+#include "base/sys_info.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/simple_thread.h"
+
 namespace reorder {
 
 namespace {
@@ -66,6 +70,67 @@ struct AverageBlockCallSort {
   }
 };
 
+// A first touch of a block in a process group, for the median time consensus.
+struct BlockTouch {
+  // The time since the start of the process group, in microseconds.
+  double time;
+  // The weight of the process touching the block.
+  double weight;
+
+  bool operator<(const BlockTouch& other) const { return time < other.time; }
+};
+
+// Used for aggregating the first touches of a block across multiple runs.
+struct MedianBlockCall {
+  MedianBlockCall() : block(NULL), total_weight(0), median_time(0) {
+  }
+
+  const block_graph::BlockGraph::Block* block;
+  std::vector<BlockTouch> touches;
+  double total_weight;
+  double median_time;
+};
+
+// Sorts by decreasing total weight, then by increasing median time. Ties are
+// broken by block ID so that the order is deterministic.
+struct MedianBlockCallSort {
+  bool operator()(const MedianBlockCall& mbc1, const MedianBlockCall& mbc2) {
+    if (mbc1.total_weight != mbc2.total_weight)
+      return mbc1.total_weight > mbc2.total_weight;
+    if (mbc1.median_time != mbc2.median_time)
+      return mbc1.median_time < mbc2.median_time;
+    return mbc1.block->id() < mbc2.block->id();
+  }
+};
+
+// Sorts the block calls of process groups by increasing time. Each run sorts
+// the next unsorted process group, so that a pool of threads can share them.
+class SortBlockCallsDelegate : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit SortBlockCallsDelegate(
+      const std::vector<std::vector<BlockCall>*>& groups)
+      : groups_(groups), next_group_(0) {
+  }
+
+  void Run() override {
+    std::vector<BlockCall>* block_calls = NULL;
+    {
+      base::AutoLock auto_lock(lock_);
+      DCHECK_LT(next_group_, groups_.size());
+      block_calls = groups_[next_group_++];
+    }
+    std::sort(block_calls->begin(), block_calls->end(),
+              BlockCallSortIncrTime());
+  }
+
+ private:
+  const std::vector<std::vector<BlockCall>*>& groups_;
+  base::Lock lock_;
+  size_t next_group_;  // Under lock_.
+
+  DISALLOW_COPY_AND_ASSIGN(SortBlockCallsDelegate);
+};
+
 // Extract the values of a map to a vector.
 template<typename K, typename V> void MapToVector(const std::map<K, V>& map,
                                                   std::vector<V>* vector) {
@@ -82,7 +147,10 @@ template<typename K, typename V> void MapToVector(const std::map<K, V>& map,
 LinearOrderGenerator::LinearOrderGenerator()
     : Reorderer::OrderGenerator("Linear Order Generator"),
       active_process_count_(0),
-      next_process_group_id_(0) {
+      next_process_group_id_(0),
+      consensus_(kAverageOrderConsensus),
+      worker_count_(base::SysInfo::NumberOfProcessors()) {
+  DCHECK_LT(0U, worker_count_);
 }
 
 LinearOrderGenerator::~LinearOrderGenerator() {
@@ -107,6 +175,32 @@ bool LinearOrderGenerator::OnProcessEnded(uint32_t process_id,
   return true;
 }
 
+bool LinearOrderGenerator::OnProcessEnvironment(
+    uint32_t process_id,
+    const TraceEnvironmentStrings& environment) {
+  if (process_type_variable_.empty())
+    return true;
+
+  for (size_t i = 0; i < environment.size(); ++i) {
+    if (environment[i].first != process_type_variable_)
+      continue;
+
+    ProcessTypeWeightMap::const_iterator it =
+        process_type_weights_.find(environment[i].second);
+    if (it != process_type_weights_.end())
+      process_weights_[process_id] = it->second;
+    break;
+  }
+
+  return true;
+}
+
+void LinearOrderGenerator::SetProcessTypeWeight(
+    const std::wstring& process_type, double weight) {
+  DCHECK_LT(0.0, weight);
+  process_type_weights_[process_type] = weight;
+}
+
 bool LinearOrderGenerator::OnCodeBlockEntry(const BlockGraph::Block* block,
                                             RelativeAddress address,
                                             uint32_t process_id,
@@ -129,27 +223,13 @@ bool LinearOrderGenerator::CalculateReordering(const PEFile& pe_file,
   LOG(INFO) << "Encountered " << process_group_calls_.size()
             << " process groups.";
 
-  // Aggregate the block calls.
-  std::map<const BlockGraph::Block*, AverageBlockCall> average_block_call_map;
-  ProcessGroupBlockCalls::const_iterator it = process_group_calls_.begin();
-  for (; it != process_group_calls_.end(); ++it) {
-    for (size_t i = 0; i < it->second.size(); ++i) {
-      const BlockCall& block_call = it->second[i];
-      AverageBlockCall& average_block_call =
-          average_block_call_map[block_call.block];
-      average_block_call.block = block_call.block;
-      average_block_call.sum_order += i;
-      ++average_block_call.call_count;
-      average_block_call.process_group_id = it->first;
-    }
-  }
-
-  // Now create a sorted list.
-  std::vector<AverageBlockCall> average_block_calls;
-  MapToVector(average_block_call_map, &average_block_calls);
-  average_block_call_map.clear();
-  std::sort(average_block_calls.begin(), average_block_calls.end(),
-            AverageBlockCallSort());
+  // Merge the first-touch orders of the process groups.
+  SortProcessGroups();
+  BlockOrder block_order;
+  if (consensus_ == kMedianTimeConsensus)
+    ComputeMedianTimeOrder(&block_order);
+  else
+    ComputeAverageOrder(&block_order);
 
   // TODO(chrisha): Create an option to evenly distribute the common startup
   //     blocks (those with call_count == process_group_calls_.size()) among
@@ -167,8 +247,8 @@ bool LinearOrderGenerator::CalculateReordering(const PEFile& pe_file,
 
   // Create the ordering from this list.
   BlockSet inserted_blocks;
-  for (size_t i = 0; i < average_block_calls.size(); ++i) {
-    const BlockGraph::Block* code_block = average_block_calls[i].block;
+  for (size_t i = 0; i < block_order.size(); ++i) {
+    const BlockGraph::Block* code_block = block_order[i];
 
     if (reorder_code) {
       order->sections[code_block->section()].blocks.push_back(
@@ -281,18 +361,137 @@ bool LinearOrderGenerator::InsertDataBlocks(size_t max_recursion_depth,
 }
 
 bool LinearOrderGenerator::CloseProcessGroup() {
-  if (block_call_map_.empty())
+  if (block_call_map_.empty()) {
+    process_weights_.clear();
     return true;
+  }
 
+  // The block calls are sorted once all the process groups are closed.
   BlockCalls& block_calls = process_group_calls_[next_process_group_id_];
+  if (!process_weights_.empty())
+    process_group_weights_[next_process_group_id_].swap(process_weights_);
   ++next_process_group_id_;
 
   MapToVector(block_call_map_, &block_calls);
   block_call_map_.clear();
-
-  std::sort(block_calls.begin(), block_calls.end(), BlockCallSortIncrTime());
+  process_weights_.clear();
 
   return true;
 }
 
+void LinearOrderGenerator::SortProcessGroups() {
+  std::vector<BlockCalls*> groups;
+  ProcessGroupBlockCalls::iterator it = process_group_calls_.begin();
+  for (; it != process_group_calls_.end(); ++it)
+    groups.push_back(&it->second);
+
+  SortBlockCallsDelegate delegate(groups);
+  if (worker_count_ == 1 || groups.size() <= 1) {
+    for (size_t i = 0; i < groups.size(); ++i)
+      delegate.Run();
+    return;
+  }
+
+  base::DelegateSimpleThreadPool pool(
+      "LinearOrderGenerator",
+      static_cast<int>(std::min(worker_count_, groups.size())));
+  pool.Start();
+  pool.AddWork(&delegate, static_cast<int>(groups.size()));
+  pool.JoinAll();
+}
+
+void LinearOrderGenerator::ComputeAverageOrder(BlockOrder* block_order) const {
+  DCHECK(block_order != NULL);
+
+  // Aggregate the block calls.
+  std::map<const BlockGraph::Block*, AverageBlockCall> average_block_call_map;
+  ProcessGroupBlockCalls::const_iterator it = process_group_calls_.begin();
+  for (; it != process_group_calls_.end(); ++it) {
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      const BlockCall& block_call = it->second[i];
+      AverageBlockCall& average_block_call =
+          average_block_call_map[block_call.block];
+      average_block_call.block = block_call.block;
+      average_block_call.sum_order += i;
+      ++average_block_call.call_count;
+      average_block_call.process_group_id = it->first;
+    }
+  }
+
+  // Now create a sorted list.
+  std::vector<AverageBlockCall> average_block_calls;
+  MapToVector(average_block_call_map, &average_block_calls);
+  average_block_call_map.clear();
+  std::sort(average_block_calls.begin(), average_block_calls.end(),
+            AverageBlockCallSort());
+
+  block_order->clear();
+  for (size_t i = 0; i < average_block_calls.size(); ++i)
+    block_order->push_back(average_block_calls[i].block);
+}
+
+void LinearOrderGenerator::ComputeMedianTimeOrder(
+    BlockOrder* block_order) const {
+  DCHECK(block_order != NULL);
+
+  // Aggregate the first touches, timed from the start of their run.
+  std::map<const BlockGraph::Block*, MedianBlockCall> median_block_call_map;
+  ProcessGroupBlockCalls::const_iterator it = process_group_calls_.begin();
+  for (; it != process_group_calls_.end(); ++it) {
+    const BlockCalls& block_calls = it->second;
+    if (block_calls.empty())
+      continue;
+
+    const ProcessWeightMap* weights = NULL;
+    ProcessGroupWeights::const_iterator weights_it =
+        process_group_weights_.find(it->first);
+    if (weights_it != process_group_weights_.end())
+      weights = &weights_it->second;
+
+    const base::Time& start = block_calls.front().time.time();
+    for (size_t i = 0; i < block_calls.size(); ++i) {
+      const BlockCall& block_call = block_calls[i];
+      BlockTouch touch = { 0.0, 1.0 };
+      touch.time = (block_call.time.time() - start).InMicrosecondsF();
+      if (weights != NULL) {
+        ProcessWeightMap::const_iterator weight =
+            weights->find(block_call.process_id);
+        if (weight != weights->end())
+          touch.weight = weight->second;
+      }
+
+      MedianBlockCall& median_block_call =
+          median_block_call_map[block_call.block];
+      median_block_call.block = block_call.block;
+      median_block_call.touches.push_back(touch);
+      median_block_call.total_weight += touch.weight;
+    }
+  }
+
+  // Compute the weighted medians, and sort the blocks by them.
+  std::vector<MedianBlockCall> median_block_calls;
+  MapToVector(median_block_call_map, &median_block_calls);
+  median_block_call_map.clear();
+  for (size_t i = 0; i < median_block_calls.size(); ++i) {
+    MedianBlockCall& median_block_call = median_block_calls[i];
+    std::vector<BlockTouch>& touches = median_block_call.touches;
+    std::sort(touches.begin(), touches.end());
+    double half_weight = median_block_call.total_weight / 2;
+    double weight = 0.0;
+    for (size_t j = 0; j < touches.size(); ++j) {
+      weight += touches[j].weight;
+      if (weight >= half_weight) {
+        median_block_call.median_time = touches[j].time;
+        break;
+      }
+    }
+  }
+  std::sort(median_block_calls.begin(), median_block_calls.end(),
+            MedianBlockCallSort());
+
+  block_order->clear();
+  for (size_t i = 0; i < median_block_calls.size(); ++i)
+    block_order->push_back(median_block_calls[i].block);
+}
+
 }  // namespace reorder
@@ -35,12 +35,23 @@
 // In the case where there is a single run of the instrumented binary, the
 // ordering will be a simple ordering of blocks by order of execution, as per
 // our original proof-of-concept ordering.
+//
+// The median time consensus instead weighs each process by its type, given by
+// an environment variable of the traced processes. Blocks are sorted by the
+// total weight of the processes that touched them (decreasing), and then by
+// the weighted median of the time of their first touch since the start of
+// their run. This keeps a few outlying runs from skewing the order of blocks
+// touched at a consistent time in all the others.
+//
+// The first-touch orders of the runs are sorted in parallel, once all the
+// traces have been consumed.
 
 #ifndef SYZYGY_REORDER_LINEAR_ORDER_GENERATOR_H_
 #define SYZYGY_REORDER_LINEAR_ORDER_GENERATOR_H_
 
 #include <map>
 #include <set>
+#include <string>
 #include <vector>
 
 #include "syzygy/reorder/reorderer.h"
@@ -53,14 +64,54 @@ class LinearOrderGenerator : public Reorderer::OrderGenerator {
  public:
   struct BlockCall;
 
+  // The ways in which the first-touch orders of the runs are merged.
+  enum Consensus {
+    // By the number of runs touching each block, then by average order.
+    kAverageOrderConsensus,
+    // By the weight of the processes touching each block, then by weighted
+    // median first-touch time.
+    kMedianTimeConsensus,
+  };
+
   LinearOrderGenerator();
   virtual ~LinearOrderGenerator();
 
+  // @name Accessors and mutators.
+  // @{
+  Consensus consensus() const { return consensus_; }
+  void set_consensus(Consensus consensus) { consensus_ = consensus; }
+
+  // The number of threads sorting the runs. Defaults to the number of
+  // processors.
+  size_t worker_count() const { return worker_count_; }
+  void set_worker_count(size_t worker_count) {
+    DCHECK_LT(0U, worker_count);
+    worker_count_ = worker_count;
+  }
+
+  // The environment variable holding the type of the traced processes.
+  const std::wstring& process_type_variable() const {
+    return process_type_variable_;
+  }
+  void set_process_type_variable(const std::wstring& process_type_variable) {
+    process_type_variable_ = process_type_variable;
+  }
+  // @}
+
+  // Sets the weight of the processes of a given type in the median time
+  // consensus. Processes have a weight of 1 by default.
+  // @param process_type the value of the process type variable.
+  // @param weight the weight of these processes. This must be positive.
+  void SetProcessTypeWeight(const std::wstring& process_type, double weight);
+
   // OrderGenerator implementation.
   virtual bool OnProcessStarted(uint32_t process_id,
                                 const UniqueTime& time) override;
   virtual bool OnProcessEnded(uint32_t process_id,
                               const UniqueTime& time) override;
+  virtual bool OnProcessEnvironment(
+      uint32_t process_id,
+      const TraceEnvironmentStrings& environment) override;
   virtual bool OnCodeBlockEntry(const BlockGraph::Block* block,
                                 RelativeAddress address,
                                 uint32_t process_id,
@@ -77,6 +128,21 @@ class LinearOrderGenerator : public Reorderer::OrderGenerator {
   typedef std::map<size_t, BlockCalls> ProcessGroupBlockCalls;
   typedef std::map<const BlockGraph::Block*, BlockCall> BlockCallMap;
   typedef std::set<const BlockGraph::Block*> BlockSet;
+  typedef std::map<uint32_t, double> ProcessWeightMap;
+  typedef std::map<size_t, ProcessWeightMap> ProcessGroupWeights;
+  typedef std::map<std::wstring, double> ProcessTypeWeightMap;
+  typedef std::vector<const BlockGraph::Block*> BlockOrder;
+
+  // Sorts the block calls of each process group by time, on worker_count_
+  // threads.
+  void SortProcessGroups();
+
+  // Merges the process groups into a single order of blocks.
+  // @param block_order receives the merged order.
+  // @{
+  void ComputeAverageOrder(BlockOrder* block_order) const;
+  void ComputeMedianTimeOrder(BlockOrder* block_order) const;
+  // @}
 
   // Called by OnFunctionEntry to update block_calls_.
   bool TouchBlock(const BlockCall& block_call);
@@ -109,6 +175,20 @@ class LinearOrderGenerator : public Reorderer::OrderGenerator {
   // Stores pointers to blocks, and the first time at which they were accessed.
   // There is one of these per 'process group'.
   BlockCallMap block_call_map_;
+
+  // The weights of the processes of the current process group, and of the
+  // processes of each closed process group. Processes without an entry have
+  // a weight of 1.
+  ProcessWeightMap process_weights_;
+  ProcessGroupWeights process_group_weights_;
+
+  // The consensus, and its configuration.
+  Consensus consensus_;
+  std::wstring process_type_variable_;
+  ProcessTypeWeightMap process_type_weights_;
+
+  // The number of threads sorting the process groups.
+  size_t worker_count_;
 };
 
 struct LinearOrderGenerator::BlockCall {
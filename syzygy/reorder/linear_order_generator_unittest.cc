@@ -15,6 +15,8 @@
 #include "syzygy/reorder/linear_order_generator.h"
 
 #include <memory>
+#include <string>
+#include <utility>
 
 #include "base/time/time.h"
 #include "gtest/gtest.h"
@@ -27,6 +29,8 @@ namespace reorder {
 
 namespace {
 
+typedef block_graph::BlockGraph::AddressSpace AddressSpace;
+
 class LinearOrderGeneratorTest : public testing::OrderGeneratorTest {
  protected:
   void ExpectLinearOrder(
@@ -156,4 +160,80 @@ TEST_F(LinearOrderGeneratorTest, ReorderCode) {
   }
 }
 
+TEST_F(LinearOrderGeneratorTest, ReorderCodeByMedianTime) {
+  // Get the first 3 blocks of the .text code section.
+  size_t section_index = input_dll_.GetSectionIndex(".text");
+  const IMAGE_SECTION_HEADER* section =
+      input_dll_.section_header(section_index);
+  ASSERT_TRUE(section != NULL);
+  AddressSpace::RangeMapConstIterPair section_blocks =
+      image_layout_.blocks.GetIntersectingBlocks(
+          core::RelativeAddress(section->VirtualAddress),
+          section->Misc.VirtualSize);
+  block_graph::ConstBlockVector blocks;
+  std::vector<core::RelativeAddress> addrs;
+  AddressSpace::RangeMapConstIter it = section_blocks.first;
+  for (; it != section_blocks.second && blocks.size() < 3; ++it) {
+    addrs.push_back(it->first.start());
+    blocks.push_back(it->second);
+  }
+  ASSERT_EQ(3U, blocks.size());
+
+  order_generator_.set_consensus(LinearOrderGenerator::kMedianTimeConsensus);
+  order_generator_.set_worker_count(2);
+  order_generator_.set_process_type_variable(L"PROCESS_TYPE");
+  order_generator_.SetProcessTypeWeight(L"browser", 4.0);
+
+  TraceEnvironmentStrings browser;
+  browser.push_back(std::make_pair(std::wstring(L"PROCESS_TYPE"),
+                                   std::wstring(L"browser")));
+  TraceEnvironmentStrings renderer;
+  renderer.push_back(std::make_pair(std::wstring(L"PROCESS_TYPE"),
+                                    std::wstring(L"renderer")));
+  base::Time start = base::Time::NowFromSystemTime();
+  base::TimeDelta ms = base::TimeDelta::FromMilliseconds(1);
+
+  // A browser process, of weight 4, touches block0 then block1.
+  order_generator_.OnProcessStarted(1, Reorderer::UniqueTime(start));
+  order_generator_.OnProcessEnvironment(1, browser);
+  order_generator_.OnCodeBlockEntry(blocks[0], addrs[0], 1, 1,
+                                    Reorderer::UniqueTime(start));
+  order_generator_.OnCodeBlockEntry(blocks[1], addrs[1], 1, 1,
+                                    Reorderer::UniqueTime(start + 10 * ms));
+  order_generator_.OnProcessEnded(1, Reorderer::UniqueTime(start + 20 * ms));
+
+  // A renderer process, of weight 1, touches block1 then block2.
+  order_generator_.OnProcessStarted(2, Reorderer::UniqueTime(start));
+  order_generator_.OnProcessEnvironment(2, renderer);
+  order_generator_.OnCodeBlockEntry(blocks[1], addrs[1], 2, 1,
+                                    Reorderer::UniqueTime(start));
+  order_generator_.OnCodeBlockEntry(blocks[2], addrs[2], 2, 1,
+                                    Reorderer::UniqueTime(start + 5 * ms));
+  order_generator_.OnProcessEnded(2, Reorderer::UniqueTime(start + 20 * ms));
+
+  // A process of no known type, of weight 1, touches block2.
+  order_generator_.OnProcessStarted(3, Reorderer::UniqueTime(start));
+  order_generator_.OnCodeBlockEntry(blocks[2], addrs[2], 3, 1,
+                                    Reorderer::UniqueTime(start));
+  order_generator_.OnProcessEnded(3, Reorderer::UniqueTime(start + 20 * ms));
+
+  // Expected ordering:
+  // - block1 (total weight 5).
+  // - block0 (total weight 4).
+  // - block2 (total weight 2).
+  EXPECT_TRUE(order_generator_.CalculateReordering(input_dll_,
+                                                   image_layout_,
+                                                   true,
+                                                   false,
+                                                   &order_));
+
+  ExpectNoDuplicateBlocks();
+
+  const BlockSpecVector& specs = order_.sections[section_index].blocks;
+  ASSERT_LE(3U, specs.size());
+  EXPECT_EQ(blocks[1], specs[0].block);
+  EXPECT_EQ(blocks[0], specs[1].block);
+  EXPECT_EQ(blocks[2], specs[2].block);
+}
+
 }  // namespace reorder
@@ -0,0 +1,291 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/reorder/page_packing_order_generator.h"
+
+#include <algorithm>
+#include <set>
+
+#include "syzygy/common/align.h"
+#include "syzygy/simulate/page_fault_simulation.h"
+
+namespace reorder {
+
+namespace {
+
+using block_graph::BlockGraph;
+using core::RelativeAddress;
+
+typedef std::vector<const BlockGraph::Block*> BlockVector;
+typedef std::vector<std::pair<Reorderer::UniqueTime, const BlockGraph::Block*>>
+    TimedBlockVector;
+
+// The rank of a touched block in the startups of the processes.
+struct BlockRank {
+  BlockRank() : block(NULL), process_count(0), rank_sum(0) {}
+
+  const BlockGraph::Block* block;
+  size_t process_count;
+  size_t rank_sum;
+};
+
+// Orders the block ranks by decreasing process count, then by increasing
+// average rank, then by block id.
+struct BlockRankLess {
+  bool operator()(const BlockRank& lhs, const BlockRank& rhs) const {
+    if (lhs.process_count != rhs.process_count)
+      return lhs.process_count > rhs.process_count;
+    size_t lhs_rank = lhs.rank_sum * rhs.process_count;
+    size_t rhs_rank = rhs.rank_sum * lhs.process_count;
+    if (lhs_rank != rhs_rank)
+      return lhs_rank < rhs_rank;
+    return lhs.block->id() < rhs.block->id();
+  }
+};
+
+// Lays out blocks back to back, honoring their alignment.
+// @param section_start the address of the first block.
+// @param block_order the blocks to lay out.
+// @param addresses receives the address of each block.
+void LayOut(RelativeAddress section_start,
+            const BlockVector& block_order,
+            std::vector<RelativeAddress>* addresses) {
+  DCHECK(addresses != NULL);
+
+  addresses->resize(block_order.size());
+  size_t address = section_start.value();
+  for (size_t i = 0; i < block_order.size(); ++i) {
+    address = common::AlignUp(address, block_order[i]->alignment());
+    (*addresses)[i] = RelativeAddress(address);
+    address += block_order[i]->size();
+  }
+}
+
+}  // namespace
+
+PagePackingOrderGenerator::PagePackingOrderGenerator()
+    : Reorderer::OrderGenerator("Page Packing Order Generator"),
+      page_size_(simulate::PageFaultSimulation::kDefaultPageSize),
+      pages_per_code_fault_(
+          simulate::PageFaultSimulation::kDefaultPagesPerCodeFault),
+      max_passes_(kDefaultMaxPasses) {
+}
+
+PagePackingOrderGenerator::~PagePackingOrderGenerator() {
+}
+
+bool PagePackingOrderGenerator::OnCodeBlockEntry(
+    const BlockGraph::Block* block,
+    RelativeAddress /*address*/,
+    uint32_t process_id,
+    uint32_t /*thread_id*/,
+    const UniqueTime& time) {
+  DCHECK(block != NULL);
+
+  // Keep around the earliest touch of the block by the process only.
+  FirstTouchMap& first_touches = first_touches_[process_id];
+  FirstTouchMap::iterator it = first_touches.find(block);
+  if (it == first_touches.end())
+    first_touches.insert(std::make_pair(block, time));
+  else if (time < it->second)
+    it->second = time;
+
+  return true;
+}
+
+bool PagePackingOrderGenerator::CalculateReordering(const PEFile& pe_file,
+                                                    const ImageLayout& image,
+                                                    bool reorder_code,
+                                                    bool reorder_data,
+                                                    Order* order) {
+  DCHECK(order != NULL);
+
+  LOG(INFO) << "Encountered " << first_touches_.size() << " processes.";
+
+  // Sort the touches of each process by time.
+  std::vector<TimedBlockVector> timed_startups;
+  ProcessFirstTouchMap::const_iterator process_it = first_touches_.begin();
+  for (; process_it != first_touches_.end(); ++process_it) {
+    timed_startups.push_back(TimedBlockVector());
+    TimedBlockVector& timed_startup = timed_startups.back();
+    FirstTouchMap::const_iterator it = process_it->second.begin();
+    for (; it != process_it->second.end(); ++it)
+      timed_startup.push_back(std::make_pair(it->second, it->first));
+    std::sort(timed_startup.begin(), timed_startup.end());
+  }
+
+  order->comment = "Page packing ordering by simulated page faults";
+  order->sections.clear();
+  order->sections.resize(image.sections.size());
+  for (size_t i = 0; i < image.sections.size(); ++i) {
+    const ImageLayout::SectionInfo& section = image.sections[i];
+    order->sections[i].id = i;
+    order->sections[i].name = section.name;
+    order->sections[i].characteristics = section.characteristics;
+
+    // Pack the touched blocks of the code sections.
+    std::set<const BlockGraph::Block*> packed_blocks;
+    bool is_code = (section.characteristics & IMAGE_SCN_CNT_CODE) != 0;
+    if (is_code && reorder_code) {
+      Startups startups(timed_startups.size());
+      for (size_t j = 0; j < timed_startups.size(); ++j) {
+        for (size_t k = 0; k < timed_startups[j].size(); ++k) {
+          const BlockGraph::Block* block = timed_startups[j][k].second;
+          if (block->section() == i)
+            startups[j].push_back(block);
+        }
+      }
+
+      BlockVector block_order;
+      PackSection(section.addr, startups, &block_order);
+      for (size_t j = 0; j < block_order.size(); ++j) {
+        order->sections[i].blocks.push_back(Order::BlockSpec(block_order[j]));
+        packed_blocks.insert(block_order[j]);
+      }
+    }
+
+    // Add the remaining blocks of the section in their original order.
+    AddressSpace::RangeMapConstIterPair section_blocks(
+        image.blocks.GetIntersectingBlocks(section.addr, section.size));
+    AddressSpace::RangeMapConstIter& section_it = section_blocks.first;
+    const AddressSpace::RangeMapConstIter& section_end = section_blocks.second;
+    for (; section_it != section_end; ++section_it) {
+      const BlockGraph::Block* block = section_it->second;
+      if (packed_blocks.count(block) == 0)
+        order->sections[i].blocks.push_back(Order::BlockSpec(block));
+    }
+  }
+
+  return true;
+}
+
+void PagePackingOrderGenerator::PackSection(RelativeAddress section_start,
+                                            const Startups& startups,
+                                            BlockVector* block_order) const {
+  DCHECK(block_order != NULL);
+
+  // Start from the order of the linear order generator.
+  std::map<const BlockGraph::Block*, BlockRank> rank_map;
+  for (size_t i = 0; i < startups.size(); ++i) {
+    for (size_t j = 0; j < startups[i].size(); ++j) {
+      BlockRank& rank = rank_map[startups[i][j]];
+      rank.block = startups[i][j];
+      ++rank.process_count;
+      rank.rank_sum += j;
+    }
+  }
+  std::vector<BlockRank> ranks;
+  std::map<const BlockGraph::Block*, BlockRank>::const_iterator rank_it =
+      rank_map.begin();
+  for (; rank_it != rank_map.end(); ++rank_it)
+    ranks.push_back(rank_it->second);
+  std::sort(ranks.begin(), ranks.end(), BlockRankLess());
+
+  BlockVector& blocks = *block_order;
+  blocks.clear();
+  for (size_t i = 0; i < ranks.size(); ++i)
+    blocks.push_back(ranks[i].block);
+
+  // Pack the blocks straddling the boundaries of the fault windows.
+  const size_t window_size = page_size_ * pages_per_code_fault_;
+  Cost best_cost = ComputeCost(section_start, startups, blocks);
+  std::vector<RelativeAddress> addresses;
+  for (size_t pass = 0; pass < max_passes_; ++pass) {
+    bool improved = false;
+    LayOut(section_start, blocks, &addresses);
+    for (size_t i = 0; i + 1 < blocks.size(); ++i) {
+      if (blocks[i]->size() == 0)
+        continue;
+      size_t start = static_cast<size_t>(addresses[i] - section_start);
+      size_t end = start + blocks[i]->size();
+      if (start / window_size == (end - 1) / window_size)
+        continue;
+
+      // Try moving the block past its successor.
+      BlockVector best_blocks;
+      BlockVector candidate(blocks);
+      std::swap(candidate[i], candidate[i + 1]);
+      Cost cost = ComputeCost(section_start, startups, candidate);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_blocks.swap(candidate);
+      }
+
+      // Try filling the gap before the boundary with a later block.
+      size_t gap = window_size - start % window_size;
+      for (size_t j = i + 1; j < blocks.size(); ++j) {
+        if (blocks[j]->size() > gap)
+          continue;
+        candidate = blocks;
+        candidate.erase(candidate.begin() + j);
+        candidate.insert(candidate.begin() + i, blocks[j]);
+        cost = ComputeCost(section_start, startups, candidate);
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_blocks.swap(candidate);
+        }
+        break;
+      }
+
+      if (!best_blocks.empty()) {
+        blocks.swap(best_blocks);
+        LayOut(section_start, blocks, &addresses);
+        improved = true;
+      }
+    }
+
+    if (!improved)
+      break;
+  }
+
+  LOG(INFO) << "Packed " << blocks.size() << " blocks in " << best_cost.first
+            << " simulated page faults.";
+}
+
+PagePackingOrderGenerator::Cost PagePackingOrderGenerator::ComputeCost(
+    RelativeAddress section_start,
+    const Startups& startups,
+    const BlockVector& block_order) const {
+  // The simulation looks at the addresses of the blocks, so it is fed
+  // stand-ins laid out in the given order.
+  std::vector<RelativeAddress> addresses;
+  LayOut(section_start, block_order, &addresses);
+  BlockGraph block_graph;
+  std::map<const BlockGraph::Block*, const BlockGraph::Block*> stand_ins;
+  for (size_t i = 0; i < block_order.size(); ++i) {
+    BlockGraph::Block* stand_in = block_graph.AddBlock(
+        BlockGraph::CODE_BLOCK, block_order[i]->size(),
+        block_order[i]->name());
+    stand_in->set_addr(addresses[i]);
+    stand_ins[block_order[i]] = stand_in;
+  }
+
+  Cost cost(0, 0);
+  for (size_t i = 0; i < startups.size(); ++i) {
+    simulate::PageFaultSimulation simulation;
+    simulation.set_page_size(page_size_);
+    simulation.set_pages_per_code_fault(pages_per_code_fault_);
+    simulation.OnProcessStarted(base::Time(), page_size_);
+    for (size_t j = 0; j < startups[i].size(); ++j) {
+      DCHECK_EQ(1U, stand_ins.count(startups[i][j]));
+      simulation.OnFunctionEntry(base::Time(), stand_ins[startups[i][j]]);
+    }
+    cost.first += simulation.fault_count();
+    cost.second += simulation.pages().size();
+  }
+
+  return cost;
+}
+
+}  // namespace reorder
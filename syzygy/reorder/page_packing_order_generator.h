@@ -0,0 +1,124 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the page packing order generator. It orders the code blocks
+// touched by the traced processes so that their startup working set is
+// brought in by as few page faults as possible, using a page fault
+// simulation as its cost function.
+//
+// The touched blocks are first laid out by the number of processes touching
+// them, then by average first-touch rank, as the linear order generator
+// does. The layout is then packed iteratively: each block straddling the
+// boundary of a fault window, the span of pages brought in by a single code
+// fault, is either moved past its successor or has a later block small
+// enough to fit the gap moved in front of it. A move is kept only when the
+// simulated startups of all processes take fewer faults, or as many faults
+// but fewer pages. Untouched blocks follow in their original order, and data
+// sections keep their original order.
+
+#ifndef SYZYGY_REORDER_PAGE_PACKING_ORDER_GENERATOR_H_
+#define SYZYGY_REORDER_PAGE_PACKING_ORDER_GENERATOR_H_
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "syzygy/reorder/reorderer.h"
+
+namespace reorder {
+
+class PagePackingOrderGenerator : public Reorderer::OrderGenerator {
+ public:
+  // The default maximum number of packing passes.
+  static const size_t kDefaultMaxPasses = 4;
+
+  PagePackingOrderGenerator();
+  virtual ~PagePackingOrderGenerator();
+
+  // @name Accessors and mutators.
+  // @{
+  // The page size defaults to simulate::PageFaultSimulation::kDefaultPageSize.
+  size_t page_size() const { return page_size_; }
+  void set_page_size(size_t page_size) {
+    DCHECK_LT(0U, page_size);
+    page_size_ = page_size;
+  }
+  // The number of pages brought in by each code fault defaults to
+  // simulate::PageFaultSimulation::kDefaultPagesPerCodeFault.
+  size_t pages_per_code_fault() const { return pages_per_code_fault_; }
+  void set_pages_per_code_fault(size_t pages_per_code_fault) {
+    DCHECK_LT(0U, pages_per_code_fault);
+    pages_per_code_fault_ = pages_per_code_fault;
+  }
+  size_t max_passes() const { return max_passes_; }
+  void set_max_passes(size_t max_passes) { max_passes_ = max_passes; }
+  // @}
+
+  // @name OrderGenerator implementation.
+  // @{
+  virtual bool OnCodeBlockEntry(const BlockGraph::Block* block,
+                                RelativeAddress address,
+                                uint32_t process_id,
+                                uint32_t thread_id,
+                                const UniqueTime& time) override;
+  virtual bool CalculateReordering(const PEFile& pe_file,
+                                   const ImageLayout& image,
+                                   bool reorder_code,
+                                   bool reorder_data,
+                                   Order* order) override;
+  // @}
+
+ protected:
+  typedef std::vector<const BlockGraph::Block*> BlockVector;
+  typedef std::map<const BlockGraph::Block*, UniqueTime> FirstTouchMap;
+  typedef std::map<uint32_t, FirstTouchMap> ProcessFirstTouchMap;
+  typedef std::vector<BlockVector> Startups;
+
+  // The cost of a layout: the number of page faults, then the number of
+  // pages loaded by the simulated startups.
+  typedef std::pair<size_t, size_t> Cost;
+
+  // Orders the blocks touched in a code section, then packs them.
+  // @param section_start the address of the section.
+  // @param startups the blocks of the section touched by each process, in
+  //     first-touch order.
+  // @param block_order receives the touched blocks, in their packed order.
+  void PackSection(RelativeAddress section_start,
+                   const Startups& startups,
+                   BlockVector* block_order) const;
+
+  // Simulates the startups with the blocks of a code section laid out in an
+  // order.
+  // @param section_start the address of the section.
+  // @param startups the blocks touched by each process, in first-touch order.
+  // @param block_order the order of the touched blocks.
+  // @returns the cost of the layout.
+  Cost ComputeCost(RelativeAddress section_start,
+                   const Startups& startups,
+                   const BlockVector& block_order) const;
+
+  // The first touch of each block, by process.
+  ProcessFirstTouchMap first_touches_;
+
+  size_t page_size_;
+  size_t pages_per_code_fault_;
+  size_t max_passes_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(PagePackingOrderGenerator);
+};
+
+}  // namespace reorder
+
+#endif  // SYZYGY_REORDER_PAGE_PACKING_ORDER_GENERATOR_H_
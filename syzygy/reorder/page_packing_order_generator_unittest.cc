@@ -0,0 +1,155 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/reorder/page_packing_order_generator.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/block_graph/block_graph.h"
+#include "syzygy/core/random_number_generator.h"
+#include "syzygy/reorder/order_generator_test.h"
+
+namespace reorder {
+
+namespace {
+
+using block_graph::BlockGraph;
+
+class TestPagePackingOrderGenerator : public PagePackingOrderGenerator {
+ public:
+  using PagePackingOrderGenerator::BlockVector;
+  using PagePackingOrderGenerator::Cost;
+  using PagePackingOrderGenerator::Startups;
+  using PagePackingOrderGenerator::ComputeCost;
+  using PagePackingOrderGenerator::PackSection;
+};
+
+class PagePackingOrderGeneratorTest : public testing::OrderGeneratorTest {
+ protected:
+  TestPagePackingOrderGenerator order_generator_;
+};
+
+}  // namespace
+
+TEST_F(PagePackingOrderGeneratorTest, DoNotReorder) {
+  EXPECT_TRUE(order_generator_.CalculateReordering(input_dll_,
+                                                   image_layout_,
+                                                   false,
+                                                   false,
+                                                   &order_));
+
+  ExpectNoDuplicateBlocks();
+
+  for (size_t i = 0; i != order_.sections.size(); ++i) {
+    const IMAGE_SECTION_HEADER* section = input_dll_.section_header(i);
+    ExpectSameOrder(section, order_.sections[i].blocks);
+  }
+}
+
+TEST_F(PagePackingOrderGeneratorTest, ReorderCode) {
+  core::RandomNumberGenerator random(12345);
+
+  // Get 5 random blocks of the .text code section.
+  size_t section_index = input_dll_.GetSectionIndex(".text");
+  const IMAGE_SECTION_HEADER* section =
+      input_dll_.section_header(section_index);
+  ASSERT_TRUE(section != NULL);
+  std::vector<core::RelativeAddress> addrs;
+  block_graph::ConstBlockVector blocks;
+  std::set<const BlockGraph::Block*> block_set;
+  while (blocks.size() < 5) {
+    core::RelativeAddress addr(
+        section->VirtualAddress + random(section->Misc.VirtualSize));
+    const BlockGraph::Block* block =
+        image_layout_.blocks.GetBlockByAddress(addr);
+    if (!block_set.insert(block).second)
+      continue;
+    addrs.push_back(addr);
+    blocks.push_back(block);
+  }
+
+  // Two processes touch the blocks in reverse order.
+  for (uint32_t process_id = 1; process_id <= 2; ++process_id) {
+    order_generator_.OnProcessStarted(process_id, GetSystemTime());
+    for (size_t i = blocks.size(); i > 0; --i) {
+      order_generator_.OnCodeBlockEntry(blocks[i - 1], addrs[i - 1],
+                                        process_id, 1, GetSystemTime());
+    }
+    order_generator_.OnProcessEnded(process_id, GetSystemTime());
+  }
+
+  EXPECT_TRUE(order_generator_.CalculateReordering(input_dll_,
+                                                   image_layout_,
+                                                   true,
+                                                   false,
+                                                   &order_));
+
+  ExpectNoDuplicateBlocks();
+
+  // The touched blocks come first in the code section, and the data sections
+  // keep their order.
+  for (size_t i = 0; i != order_.sections.size(); ++i) {
+    const IMAGE_SECTION_HEADER* section = input_dll_.section_header(i);
+    if (i == section_index) {
+      ASSERT_LE(blocks.size(), order_.sections[i].blocks.size());
+      for (size_t j = 0; j < blocks.size(); ++j)
+        EXPECT_EQ(1U, block_set.count(order_.sections[i].blocks[j].block));
+    } else if ((section->Characteristics & IMAGE_SCN_CNT_CODE) == 0) {
+      ExpectSameOrder(section, order_.sections[i].blocks);
+    }
+  }
+}
+
+TEST(PagePackingOrderGeneratorPackTest, PacksStraddlingBlocks) {
+  BlockGraph block_graph;
+  const BlockGraph::Block* a =
+      block_graph.AddBlock(BlockGraph::CODE_BLOCK, 0x800, "a");
+  const BlockGraph::Block* b =
+      block_graph.AddBlock(BlockGraph::CODE_BLOCK, 0x100, "b");
+  const BlockGraph::Block* c =
+      block_graph.AddBlock(BlockGraph::CODE_BLOCK, 0x900, "c");
+
+  TestPagePackingOrderGenerator order_generator;
+  order_generator.set_page_size(0x1000);
+  order_generator.set_pages_per_code_fault(1);
+
+  // Two processes touch a and c, and a third one touches a and b. The
+  // linear order is then a, c, b, where c straddles the first page.
+  TestPagePackingOrderGenerator::Startups startups(3);
+  for (size_t i = 0; i < 2; ++i) {
+    startups[i].push_back(a);
+    startups[i].push_back(c);
+  }
+  startups[2].push_back(a);
+  startups[2].push_back(b);
+
+  TestPagePackingOrderGenerator::BlockVector linear_order;
+  linear_order.push_back(a);
+  linear_order.push_back(c);
+  linear_order.push_back(b);
+  EXPECT_EQ(6U, order_generator.ComputeCost(
+      core::RelativeAddress(0x1000), startups, linear_order).first);
+
+  // Moving b in front of c spares the third process a fault.
+  TestPagePackingOrderGenerator::BlockVector block_order;
+  order_generator.PackSection(
+      core::RelativeAddress(0x1000), startups, &block_order);
+  ASSERT_EQ(3U, block_order.size());
+  EXPECT_EQ(a, block_order[0]);
+  EXPECT_EQ(b, block_order[1]);
+  EXPECT_EQ(c, block_order[2]);
+  EXPECT_EQ(5U, order_generator.ComputeCost(
+      core::RelativeAddress(0x1000), startups, block_order).first);
+}
+
+}  // namespace reorder
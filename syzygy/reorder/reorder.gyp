@@ -29,6 +29,8 @@
         'linear_order_generator.h',
         'orderers/explicit_orderer.cc',
         'orderers/explicit_orderer.h',
+        'page_packing_order_generator.cc',
+        'page_packing_order_generator.h',
         'random_order_generator.cc',
         'random_order_generator.h',
         'reorder_app.cc',
@@ -46,6 +48,7 @@
         '<(src)/syzygy/pdb/pdb.gyp:pdb_lib',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/playback/playback.gyp:playback_lib',
+        '<(src)/syzygy/simulate/simulate.gyp:simulate_lib',
       ],
     },
     {
@@ -82,6 +85,7 @@
         'order_generator_test.cc',
         'order_generator_test.h',
         'orderers/explicit_orderer_unittest.cc',
+        'page_packing_order_generator_unittest.cc',
         'random_order_generator_unittest.cc',
         'reorder_app_unittest.cc',
         'reorderer_unittest.cc',
@@ -22,12 +22,14 @@
 #include "base/strings/string_number_conversions.h"
 #include "base/strings/string_split.h"
 #include "base/strings/stringprintf.h"
+#include "base/strings/utf_string_conversions.h"
 #include "syzygy/grinder/basic_block_util.h"
 #include "syzygy/grinder/indexed_frequency_data_serializer.h"
 #include "syzygy/pe/find.h"
 #include "syzygy/reorder/basic_block_optimizer.h"
 #include "syzygy/reorder/dead_code_finder.h"
 #include "syzygy/reorder/linear_order_generator.h"
+#include "syzygy/reorder/page_packing_order_generator.h"
 #include "syzygy/reorder/random_order_generator.h"
 
 namespace reorder {
@@ -57,8 +59,25 @@ static const char kUsageFormatStr[] =
     "    --seed=INT generates a random ordering; don't specify ETW log files.\n"
     "    --list-dead-code instead of an ordering, output the set of functions\n"
     "        not visited during the trace.\n"
+    "    --page-packing orders the code blocks so that their startup working\n"
+    "        set is brought in by as few page faults as possible.\n"
+    "    --page-size=INT the page size of the page packing simulation.\n"
+    "        Defaults to 4096.\n"
+    "    --pages-per-code-fault=INT the number of pages brought in by each\n"
+    "        code fault in the page packing simulation. Defaults to 8.\n"
     "    --pretty-print enables pretty printing of the JSON output file.\n"
+    "    --binary-output writes the order in a compact binary format that\n"
+    "        loads faster than JSON. relink accepts either format.\n"
     "    --reorderer-flags=<comma separated reorderer flags>\n"
+    "    --consensus=<average|median> how the runs seen in the traces are\n"
+    "        merged in linear order mode. average orders blocks by the number\n"
+    "        of runs they're seen in, then by average order. median orders\n"
+    "        them by the weight of the processes they're seen in, then by\n"
+    "        weighted median first-touch time. Defaults to average.\n"
+    "    --process-type-variable=NAME the environment variable holding the\n"
+    "        type of the traced processes, for the median consensus.\n"
+    "    --process-type-weights=<comma separated TYPE:WEIGHT pairs> the\n"
+    "        weights of the processes of each type. Defaults to 1.\n"
     "  Reorderer Flags:\n"
     "    no-code: Do not reorder code sections.\n"
     "    no-data: Do not reorder data sections.\n"
@@ -99,6 +118,52 @@ bool ParseFlags(const std::string& flags_str, Reorderer::Flags* flags) {
   return true;
 }
 
+// Parses process type weights. Returns true on success, false otherwise.
+bool ParseProcessTypeWeights(const std::string& weights_str,
+                             ReorderApp::ProcessTypeWeightMap* weights) {
+  DCHECK(weights != NULL);
+
+  typedef std::vector<std::string> StringVector;
+  StringVector pairs = base::SplitString(
+      weights_str, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    StringVector type_and_weight = base::SplitString(
+        pairs[i], ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+    double weight = 0.0;
+    if (type_and_weight.size() != 2 ||
+        !base::StringToDouble(type_and_weight[1], &weight) ||
+        weight <= 0.0) {
+      LOG(ERROR) << "Invalid process type weight: " << pairs[i] << ".";
+      return false;
+    }
+    (*weights)[base::UTF8ToWide(type_and_weight[0])] = weight;
+  }
+
+  return true;
+}
+
+// Parses an optional switch holding a positive integer. Returns true on
+// success, leaving @p value untouched if the switch is absent, false
+// otherwise.
+bool ParsePositiveSwitch(const base::CommandLine* command_line,
+                         const char* name,
+                         size_t* value) {
+  DCHECK(command_line != NULL);
+  DCHECK(value != NULL);
+
+  if (!command_line->HasSwitch(name))
+    return true;
+
+  unsigned int tmp_value = 0;
+  if (!base::StringToUint(command_line->GetSwitchValueASCII(name),
+                          &tmp_value) ||
+      tmp_value == 0) {
+    return false;
+  }
+  *value = tmp_value;
+  return true;
+}
+
 }  // namespace
 
 const char ReorderApp::kInstrumentedImage[] = "instrumented-image";
@@ -107,8 +172,18 @@ const char ReorderApp::kInputImage[] = "input-image";
 const char ReorderApp::kBasicBlockEntryCounts[] = "basic-block-entry-counts";
 const char ReorderApp::kSeed[] = "seed";
 const char ReorderApp::kListDeadCode[] = "list-dead-code";
+const char ReorderApp::kDeadCodeDatabase[] = "dead-code-database";
+const char ReorderApp::kMinLiveRuns[] = "min-live-runs";
+const char ReorderApp::kColdSection[] = "cold-section";
+const char ReorderApp::kPagePacking[] = "page-packing";
+const char ReorderApp::kPageSize[] = "page-size";
+const char ReorderApp::kPagesPerCodeFault[] = "pages-per-code-fault";
 const char ReorderApp::kPrettyPrint[] = "pretty-print";
+const char ReorderApp::kBinaryOutput[] = "binary-output";
 const char ReorderApp::kReordererFlags[] = "reorderer-flags";
+const char ReorderApp::kConsensus[] = "consensus";
+const char ReorderApp::kProcessTypeVariable[] = "process-type-variable";
+const char ReorderApp::kProcessTypeWeights[] = "process-type-weights";
 const char ReorderApp::kInstrumentedDll[] = "instrumented-dll";
 const char ReorderApp::kInputDll[] = "input-dll";
 
@@ -116,8 +191,13 @@ ReorderApp::ReorderApp()
     : AppImplBase("Reorder"),
       mode_(kInvalidMode),
       seed_(0),
+      page_size_(0),
+      pages_per_code_fault_(0),
+      min_live_runs_(0),
       pretty_print_(false),
-      flags_(0) {
+      binary_output_(false),
+      flags_(0),
+      median_consensus_(false) {
 }
 
 bool ReorderApp::ParseCommandLine(const base::CommandLine* command_line) {
@@ -157,11 +237,30 @@ bool ReorderApp::ParseCommandLine(const base::CommandLine* command_line) {
   // Parse the pretty-print switch.
   pretty_print_ = command_line->HasSwitch(kPrettyPrint);
 
+  // Parse the binary-output switch.
+  binary_output_ = command_line->HasSwitch(kBinaryOutput);
+
+  // Parse the consensus of the linear order generator.
+  std::string consensus(command_line->GetSwitchValueASCII(kConsensus));
+  if (consensus == "median") {
+    median_consensus_ = true;
+  } else if (!consensus.empty() && consensus != "average") {
+    return Usage(command_line, "Unknown consensus.");
+  }
+  process_type_variable_ =
+      command_line->GetSwitchValueNative(kProcessTypeVariable);
+  if (!ParseProcessTypeWeights(
+          command_line->GetSwitchValueASCII(kProcessTypeWeights),
+          &process_type_weights_)) {
+    return Usage(command_line, "Invalid process type weights.");
+  }
+
   // Make all of the input paths absolute.
   input_image_path_ = AbsolutePath(input_image_path_);
   instrumented_image_path_ = AbsolutePath(instrumented_image_path_);
   output_file_path_ = AbsolutePath(output_file_path_);
   bb_entry_count_file_path_ = AbsolutePath(bb_entry_count_file_path_);
+  dead_code_database_path_ = AbsolutePath(dead_code_database_path_);
 
   // Capture the (possibly empty) set of trace files to read.
   for (size_t i = 0; i < command_line->GetArgs().size(); ++i) {
@@ -196,6 +295,29 @@ bool ReorderApp::ParseCommandLine(const base::CommandLine* command_line) {
     }
     mode_ = kDeadCodeFinderMode;
   }
+  dead_code_database_path_ =
+      command_line->GetSwitchValuePath(kDeadCodeDatabase);
+  if (!ParsePositiveSwitch(command_line, kMinLiveRuns, &min_live_runs_))
+    return Usage(command_line, "Invalid minimum number of live runs.");
+  cold_section_name_ = command_line->GetSwitchValueASCII(kColdSection);
+  if (command_line->HasSwitch(kColdSection) && cold_section_name_.empty())
+    return Usage(command_line, "Invalid cold section name.");
+
+  // Parse the page-packing switch and the parameters of its simulation.
+  if (command_line->HasSwitch(kPagePacking)) {
+    if (mode_ != kInvalidMode) {
+      LOG(ERROR) << "--" << kPagePacking << ", --" << kListDeadCode
+                 << " and --" << kSeed << "=N are mutually exclusive.";
+      return false;
+    }
+    mode_ = kPagePackingMode;
+  }
+  if (!ParsePositiveSwitch(command_line, kPageSize, &page_size_))
+    return Usage(command_line, "Invalid page size.");
+  if (!ParsePositiveSwitch(command_line, kPagesPerCodeFault,
+                           &pages_per_code_fault_)) {
+    return Usage(command_line, "Invalid number of pages per code fault.");
+  }
 
   // If we haven't found anything to over-ride the default mode (linear order),
   // then the default it is.
@@ -208,6 +330,15 @@ bool ReorderApp::ParseCommandLine(const base::CommandLine* command_line) {
                  "Trace files are not accepted in random order mode.");
   }
 
+  // We only accept the dead code finder parameters in dead code finder mode.
+  if (mode_ != kDeadCodeFinderMode &&
+      (!dead_code_database_path_.empty() || min_live_runs_ != 0 ||
+       !cold_section_name_.empty())) {
+    return Usage(command_line,
+                 "The dead code database, minimum number of live runs and "
+                 "cold section are only accepted in dead code finder mode.");
+  }
+
   // We only accept a basic-block entry count file in linear order mode, and
   // we require the input image path when we do so.
   if (!bb_entry_count_file_path_.empty()) {
@@ -229,17 +360,47 @@ bool ReorderApp::ParseCommandLine(const base::CommandLine* command_line) {
 
 bool ReorderApp::SetUp() {
   switch (mode_) {
-    case kLinearOrderMode:
-      order_generator_.reset(new LinearOrderGenerator());
+    case kLinearOrderMode: {
+      LinearOrderGenerator* linear_order_generator = new LinearOrderGenerator();
+      order_generator_.reset(linear_order_generator);
+      if (median_consensus_) {
+        linear_order_generator->set_consensus(
+            LinearOrderGenerator::kMedianTimeConsensus);
+      }
+      linear_order_generator->set_process_type_variable(
+          process_type_variable_);
+      ProcessTypeWeightMap::const_iterator it = process_type_weights_.begin();
+      for (; it != process_type_weights_.end(); ++it)
+        linear_order_generator->SetProcessTypeWeight(it->first, it->second);
       return true;
+    }
 
     case kRandomOrderMode:
       order_generator_.reset(new RandomOrderGenerator(seed_));
       return true;
 
-    case kDeadCodeFinderMode:
-      order_generator_.reset(new DeadCodeFinder());
+    case kDeadCodeFinderMode: {
+      DeadCodeFinder* dead_code_finder = new DeadCodeFinder();
+      order_generator_.reset(dead_code_finder);
+      dead_code_finder->set_database_path(dead_code_database_path_);
+      if (min_live_runs_ != 0)
+        dead_code_finder->set_min_live_runs(min_live_runs_);
+      dead_code_finder->set_cold_section_name(cold_section_name_);
+      return true;
+    }
+
+    case kPagePackingMode: {
+      PagePackingOrderGenerator* page_packing_order_generator =
+          new PagePackingOrderGenerator();
+      order_generator_.reset(page_packing_order_generator);
+      if (page_size_ != 0)
+        page_packing_order_generator->set_page_size(page_size_);
+      if (pages_per_code_fault_ != 0) {
+        page_packing_order_generator->set_pages_per_code_fault(
+            pages_per_code_fault_);
+      }
       return true;
+    }
   }
 
   NOTREACHED();
@@ -275,8 +436,15 @@ int ReorderApp::Run() {
     }
   }
 
-  // Serialize the order to JSON.
-  if (!order.SerializeToJSON(input_image, output_file_path_, pretty_print_)) {
+  // Serialize the order.
+  bool serialized = false;
+  if (binary_output_) {
+    serialized = order.SerializeToBinary(input_image, output_file_path_);
+  } else {
+    serialized = order.SerializeToJSON(input_image, output_file_path_,
+                                       pretty_print_);
+  }
+  if (!serialized) {
     LOG(ERROR) << "Unable to output order.";
     return 1;
   }
@@ -15,7 +15,9 @@
 #ifndef SYZYGY_REORDER_REORDER_APP_H_
 #define SYZYGY_REORDER_REORDER_APP_H_
 
+#include <map>
 #include <memory>
+#include <string>
 
 #include "base/command_line.h"
 #include "base/files/file_path.h"
@@ -31,6 +33,8 @@ namespace reorder {
 // This class implements the command-line reorder utility.
 class ReorderApp : public application::AppImplBase {
  public:
+  typedef std::map<std::wstring, double> ProcessTypeWeightMap;
+
   ReorderApp();
 
   // @name Implementation of the AppImplBase interface.
@@ -47,7 +51,8 @@ class ReorderApp : public application::AppImplBase {
     kInvalidMode,
     kLinearOrderMode,
     kRandomOrderMode,
-    kDeadCodeFinderMode
+    kDeadCodeFinderMode,
+    kPagePackingMode
   };
   // @name Utility members.
   // @{
@@ -67,10 +72,19 @@ class ReorderApp : public application::AppImplBase {
   base::FilePath input_image_path_;
   base::FilePath output_file_path_;
   base::FilePath bb_entry_count_file_path_;
+  base::FilePath dead_code_database_path_;
   FilePathVector trace_file_paths_;
   uint32_t seed_;
+  size_t page_size_;
+  size_t pages_per_code_fault_;
+  size_t min_live_runs_;
+  std::string cold_section_name_;
   bool pretty_print_;
+  bool binary_output_;
   Reorderer::Flags flags_;
+  bool median_consensus_;
+  std::wstring process_type_variable_;
+  ProcessTypeWeightMap process_type_weights_;
   // @}
 
   // Command-line parameter names. Exposed as protected for unit-testing.
@@ -81,8 +95,18 @@ class ReorderApp : public application::AppImplBase {
   static const char kBasicBlockEntryCounts[];
   static const char kSeed[];
   static const char kListDeadCode[];
+  static const char kDeadCodeDatabase[];
+  static const char kMinLiveRuns[];
+  static const char kColdSection[];
+  static const char kPagePacking[];
+  static const char kPageSize[];
+  static const char kPagesPerCodeFault[];
   static const char kPrettyPrint[];
+  static const char kBinaryOutput[];
   static const char kReordererFlags[];
+  static const char kConsensus[];
+  static const char kProcessTypeVariable[];
+  static const char kProcessTypeWeights[];
   static const char kInstrumentedDll[];
   static const char kInputDll[];
   // @}
@@ -44,23 +44,43 @@ class TestReorderApp : public ReorderApp {
   using ReorderApp::kLinearOrderMode;
   using ReorderApp::kRandomOrderMode;
   using ReorderApp::kDeadCodeFinderMode;
+  using ReorderApp::kPagePackingMode;
   using ReorderApp::mode_;
   using ReorderApp::instrumented_image_path_;
   using ReorderApp::input_image_path_;
   using ReorderApp::output_file_path_;
   using ReorderApp::bb_entry_count_file_path_;
+  using ReorderApp::dead_code_database_path_;
   using ReorderApp::trace_file_paths_;
   using ReorderApp::seed_;
+  using ReorderApp::page_size_;
+  using ReorderApp::pages_per_code_fault_;
+  using ReorderApp::min_live_runs_;
+  using ReorderApp::cold_section_name_;
   using ReorderApp::pretty_print_;
+  using ReorderApp::binary_output_;
   using ReorderApp::flags_;
+  using ReorderApp::median_consensus_;
+  using ReorderApp::process_type_variable_;
+  using ReorderApp::process_type_weights_;
   using ReorderApp::kInstrumentedImage;
   using ReorderApp::kOutputFile;
   using ReorderApp::kInputImage;
   using ReorderApp::kBasicBlockEntryCounts;
   using ReorderApp::kSeed;
   using ReorderApp::kListDeadCode;
+  using ReorderApp::kDeadCodeDatabase;
+  using ReorderApp::kMinLiveRuns;
+  using ReorderApp::kColdSection;
+  using ReorderApp::kPagePacking;
+  using ReorderApp::kPageSize;
+  using ReorderApp::kPagesPerCodeFault;
   using ReorderApp::kPrettyPrint;
+  using ReorderApp::kBinaryOutput;
   using ReorderApp::kReordererFlags;
+  using ReorderApp::kConsensus;
+  using ReorderApp::kProcessTypeVariable;
+  using ReorderApp::kProcessTypeWeights;
   using ReorderApp::kInstrumentedDll;
   using ReorderApp::kInputDll;
 };
@@ -237,6 +257,7 @@ TEST_F(ReorderAppTest, ParseMinimalLinearOrderCommandLine) {
   EXPECT_EQ(abs_trace_file_path_, test_impl_.trace_file_paths_.front());
   EXPECT_EQ(0U, test_impl_.seed_);
   EXPECT_FALSE(test_impl_.pretty_print_);
+  EXPECT_FALSE(test_impl_.binary_output_);
   EXPECT_EQ(Reorderer::kFlagReorderCode | Reorderer::kFlagReorderData,
             test_impl_.flags_);
 
@@ -253,6 +274,7 @@ TEST_F(ReorderAppTest, ParseFullLinearOrderCommandLine) {
   cmd_line_.AppendSwitchASCII(
       TestReorderApp::kReordererFlags, "no-data,no-code");
   cmd_line_.AppendSwitch(TestReorderApp::kPrettyPrint);
+  cmd_line_.AppendSwitch(TestReorderApp::kBinaryOutput);
   cmd_line_.AppendArgPath(trace_file_path_);
 
   ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
@@ -266,12 +288,85 @@ TEST_F(ReorderAppTest, ParseFullLinearOrderCommandLine) {
   EXPECT_EQ(abs_trace_file_path_, test_impl_.trace_file_paths_.front());
   EXPECT_EQ(0U, test_impl_.seed_);
   EXPECT_TRUE(test_impl_.pretty_print_);
+  EXPECT_TRUE(test_impl_.binary_output_);
   EXPECT_EQ(0, test_impl_.flags_ & Reorderer::kFlagReorderCode);
   EXPECT_EQ(0, test_impl_.flags_ & Reorderer::kFlagReorderData);
 
   EXPECT_TRUE(test_impl_.SetUp());
 }
 
+TEST_F(ReorderAppTest, ParseMedianConsensusCommandLine) {
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kConsensus, "median");
+  cmd_line_.AppendSwitchASCII(
+      TestReorderApp::kProcessTypeVariable, "PROCESS_TYPE");
+  cmd_line_.AppendSwitchASCII(
+      TestReorderApp::kProcessTypeWeights, "browser:4,renderer:0.5");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+
+  EXPECT_TRUE(test_impl_.median_consensus_);
+  EXPECT_EQ(std::wstring(L"PROCESS_TYPE"), test_impl_.process_type_variable_);
+  ASSERT_EQ(2U, test_impl_.process_type_weights_.size());
+  EXPECT_EQ(4.0, test_impl_.process_type_weights_[L"browser"]);
+  EXPECT_EQ(0.5, test_impl_.process_type_weights_[L"renderer"]);
+
+  EXPECT_TRUE(test_impl_.SetUp());
+}
+
+TEST_F(ReorderAppTest, ParseWithUnknownConsensusFails) {
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kConsensus, "mode");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(ReorderAppTest, ParseWithInvalidProcessTypeWeightsFails) {
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitchASCII(
+      TestReorderApp::kProcessTypeWeights, "browser:-1");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(ReorderAppTest, ParsePagePackingCommandLine) {
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitch(TestReorderApp::kPagePacking);
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kPageSize, "8192");
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kPagesPerCodeFault, "4");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+
+  EXPECT_EQ(TestReorderApp::kPagePackingMode, test_impl_.mode_);
+  EXPECT_EQ(8192U, test_impl_.page_size_);
+  EXPECT_EQ(4U, test_impl_.pages_per_code_fault_);
+
+  EXPECT_TRUE(test_impl_.SetUp());
+}
+
+TEST_F(ReorderAppTest, ParseWithInvalidPageSizeFails) {
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitch(TestReorderApp::kPagePacking);
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kPageSize, "0");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(ReorderAppTest, ParseMinimalDeprecatedLinearOrderCommandLine) {
   cmd_line_.AppendSwitchPath(
       TestReorderApp::kInstrumentedDll, instrumented_image_path_);
@@ -363,6 +458,49 @@ TEST_F(ReorderAppTest, ParseDeadCodeFinderCommandLine) {
   EXPECT_TRUE(test_impl_.SetUp());
 }
 
+TEST_F(ReorderAppTest, ParseDeadCodeFinderColdSectionCommandLine) {
+  base::FilePath database_path(L"dead_code.json");
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitch(TestReorderApp::kListDeadCode);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kDeadCodeDatabase, database_path);
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kMinLiveRuns, "3");
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kColdSection, ".cold");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_TRUE(test_impl_.ParseCommandLine(&cmd_line_));
+
+  EXPECT_EQ(TestReorderApp::kDeadCodeFinderMode, test_impl_.mode_);
+  EXPECT_EQ(TestReorderApp::AbsolutePath(database_path),
+            test_impl_.dead_code_database_path_);
+  EXPECT_EQ(3U, test_impl_.min_live_runs_);
+  EXPECT_EQ(".cold", test_impl_.cold_section_name_);
+
+  EXPECT_TRUE(test_impl_.SetUp());
+}
+
+TEST_F(ReorderAppTest, ParseColdSectionWithoutListDeadCodeFails) {
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kColdSection, ".cold");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(ReorderAppTest, ParseZeroMinLiveRunsFails) {
+  cmd_line_.AppendSwitchPath(
+      TestReorderApp::kInstrumentedImage, instrumented_image_path_);
+  cmd_line_.AppendSwitchPath(TestReorderApp::kOutputFile, output_file_path_);
+  cmd_line_.AppendSwitch(TestReorderApp::kListDeadCode);
+  cmd_line_.AppendSwitchASCII(TestReorderApp::kMinLiveRuns, "0");
+  cmd_line_.AppendArgPath(trace_file_path_);
+
+  ASSERT_FALSE(test_impl_.ParseCommandLine(&cmd_line_));
+}
+
 TEST_F(ReorderAppTest, LinearOrderEndToEnd) {
   cmd_line_.AppendSwitchPath(
       TestReorderApp::kInstrumentedImage, instrumented_image_path_);
@@ -16,6 +16,7 @@
 
 #include "base/values.h"
 #include "base/files/file_util.h"
+#include "base/files/scoped_file.h"
 #include "base/json/json_reader.h"
 #include "base/json/string_escape.h"
 #include "base/strings/stringprintf.h"
@@ -49,6 +50,12 @@ const char kSectionNameKey[] = "name";
 const char kSectionCharacteristicsKey[] = "characteristics";
 const char kBlocksKey[] = "blocks";
 
+// The magic number and version at the top of binary order files. The magic
+// number reads "SZOR" in a hex dump. Bump the version whenever the format
+// changes.
+const uint32_t kBinaryOrderMagic = 0x524F5A53;
+const uint32_t kBinaryOrderVersion = 1;
+
 bool OutputTrailingBlockComment(const BlockGraph::Block* block,
                                 core::JSONFileWriter* json_file) {
   DCHECK(block != NULL);
@@ -172,6 +179,51 @@ bool OutputSectionSpec(const Reorderer::Order::SectionSpec& section_spec,
   return true;
 }
 
+// Resolves the block at @p address in the original image, and validates the
+// basic-block offsets already in @p block_spec against it.
+bool ResolveBlockSpec(const pe::ImageLayout& image,
+                      uint32_t address,
+                      Reorderer::Order::BlockSpec* block_spec) {
+  DCHECK(block_spec != NULL);
+
+  block_spec->block = NULL;
+
+  // Resolve the referenced block.
+  core::RelativeAddress rva(address);
+  const BlockGraph::Block* block = image.blocks.GetBlockByAddress(rva);
+  if (block == NULL) {
+    LOG(ERROR) << "Block address not found in decomposed image: "
+                << address;
+    return false;
+  }
+
+  // Validate the basic_block offsets.
+  bool seen_end_block = false;
+  for (size_t i = 0; i < block_spec->basic_block_offsets.size(); ++i) {
+    BlockGraph::Offset offset = block_spec->basic_block_offsets[i];
+    if (offset < 0 ||
+        static_cast<BlockGraph::Size>(offset) > block->size()) {
+      LOG(ERROR) << "Offset " << offset << " falls outside block range [0-"
+                 << block->size() << "] for " << block->name();
+      return false;
+    }
+
+    // The basic-end block must be last in the block specification. The
+    // block builder will catch this error but we can meaningfully catch this
+    // earlier and avoid a lot of computation for nothing.
+    if (static_cast<BlockGraph::Size>(offset) == block->size()) {
+      seen_end_block = true;
+    } else if (seen_end_block) {
+      LOG(ERROR) << "Encountered basic-end block that is not last in the "
+                 << "specified ordering.";
+      return false;
+    }
+  }
+
+  block_spec->block = block;
+  return true;
+}
+
 bool LoadBlockSpec(const pe::ImageLayout& image,
                    const Value* block_value,
                    Reorderer::Order::BlockSpec* block_spec) {
@@ -197,49 +249,52 @@ bool LoadBlockSpec(const pe::ImageLayout& image,
     }
   }
 
-  // Resolve the referenced block.
-  core::RelativeAddress rva(address);
-  const BlockGraph::Block* block = image.blocks.GetBlockByAddress(rva);
-  if (block == NULL) {
-    LOG(ERROR) << "Block address not found in decomposed image: "
-                << address;
-    return false;
-  }
-
   // Read in the basic_block offsets.
-  bool seen_end_block = false;
   if (rva_list != NULL && !rva_list->empty()) {
     block_spec->basic_block_offsets.reserve(rva_list->GetSize());
     for (size_t i = 0; i < rva_list->GetSize(); ++i) {
       int offset = 0;
       if (!rva_list->GetInteger(i, &offset)) {
         LOG(ERROR) << "Unexpected value for basic-block offset #" << i
-                   << " of " << address << " [" << block->name() << "].";
+                   << " of " << address << ".";
         block_spec->basic_block_offsets.clear();
         return false;
       }
-      if (offset < 0 ||
-          static_cast<BlockGraph::Size>(offset) > block->size()) {
-        LOG(ERROR) << "Offset " << offset << " falls outside block range [0-"
-                   << block->size() << "] for " << block->name();
-        return false;
-      }
-
-      // The basic-end block must be last in the block specification. The
-      // block builder will catch this error but we can meaningfully catch this
-      // earlier and avoid a lot of computation for nothing.
-      if (static_cast<BlockGraph::Size>(offset) == block->size()) {
-        seen_end_block = true;
-      } else if (seen_end_block) {
-        LOG(ERROR) << "Encountered basic-end block that is not last in the "
-                   << "specified ordering.";
-        return false;
-      }
       block_spec->basic_block_offsets.push_back(offset);
     }
   }
 
-  block_spec->block = block;
+  return ResolveBlockSpec(image, address, block_spec);
+}
+
+// Looks up the original section of @p section_spec, if it refers to one, and
+// populates its metadata from it.
+bool ResolveSectionId(const pe::ImageLayout& image,
+                      Reorderer::Order::SectionSpec* section_spec,
+                      std::set<size_t>* seen_section_ids) {
+  DCHECK(section_spec != NULL);
+  DCHECK(seen_section_ids != NULL);
+
+  if (section_spec->id == Reorderer::Order::SectionSpec::kNewSectionId)
+    return true;
+
+  // Lookup the section in the original image layout.
+  if (section_spec->id < 0 || section_spec->id > image.sections.size()) {
+    LOG(ERROR) << "Invalid section id: " << section_spec->id << ".";
+    return false;
+  }
+
+  // Make sure this section id does not already exist.
+  if (!seen_section_ids->insert(section_spec->id).second) {
+    LOG(ERROR) << "Section ID " << section_spec->id << " redefined.";
+    return false;
+  }
+
+  // Copy the metadata into the section spec.
+  section_spec->name = image.sections[section_spec->id].name;
+  section_spec->characteristics =
+      image.sections[section_spec->id].characteristics;
+
   return true;
 }
 
@@ -270,24 +325,8 @@ bool LoadSectionSpec(const pe::ImageLayout& image,
   // will be inspected below to see if any of the metadata needs to be
   // over-ridden.
   section_spec->id = tmp_section_id;
-  if (section_spec->id != Reorderer::Order::SectionSpec::kNewSectionId) {
-    // Lookup the section in the original image layout.
-    if (section_spec->id < 0 || section_spec->id > image.sections.size()) {
-      LOG(ERROR) << "Invalid section id: " << section_spec->id << ".";
-      return false;
-    }
-
-    // Make sure this section id does not already exist.
-    if (!seen_section_ids->insert(section_spec->id).second) {
-      LOG(ERROR) << "Section ID " << section_spec->id << " redefined.";
-      return false;
-    }
-
-    // Copy the metadata into the section spec.
-    section_spec->name = image.sections[section_spec->id].name;
-    section_spec->characteristics =
-        image.sections[section_spec->id].characteristics;
-  }
+  if (!ResolveSectionId(image, section_spec, seen_section_ids))
+    return false;
 
   // Possibly over-ride the section name.
   if (section_value->HasKey(section_name_key) &&
@@ -345,6 +384,30 @@ bool LoadSectionSpec(const pe::ImageLayout& image,
   return true;
 }
 
+// Reads the header of a binary order file, up to and including the metadata.
+bool LoadBinaryOrderHeader(core::InArchive* in_archive,
+                           pe::Metadata* metadata) {
+  DCHECK(in_archive != NULL);
+  DCHECK(metadata != NULL);
+
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  if (!in_archive->Load(&magic) || magic != kBinaryOrderMagic) {
+    LOG(ERROR) << "Not a binary order file.";
+    return false;
+  }
+  if (!in_archive->Load(&version) || version != kBinaryOrderVersion) {
+    LOG(ERROR) << "Unsupported binary order file version: " << version << ".";
+    return false;
+  }
+  if (!metadata->Load(in_archive)) {
+    LOG(ERROR) << "Unable to read binary order file metadata.";
+    return false;
+  }
+
+  return true;
+}
+
 }  // namespace
 
 const size_t Reorderer::Order::SectionSpec::kNewSectionId = ~1U;
@@ -436,6 +499,13 @@ void Reorderer::OnProcessStarted(
     parser_.set_error_occurred(true);
     return;
   }
+
+  if (data != NULL &&
+      !order_generator_->OnProcessEnvironment(process_id,
+                                              data->environment_strings)) {
+    parser_.set_error_occurred(true);
+    return;
+  }
 }
 
 void Reorderer::OnProcessEnded(base::Time time, DWORD process_id) {
@@ -627,8 +697,182 @@ bool Reorderer::Order::LoadFromJSON(const PEFile& pe,
   return true;
 }
 
+bool Reorderer::Order::SerializeToBinary(const PEFile& pe,
+                                         const base::FilePath& path) const {
+  PEFile::Signature orig_sig;
+  pe.GetSignature(&orig_sig);
+  pe::Metadata metadata;
+  if (!metadata.Init(orig_sig))
+    return false;
+
+  base::ScopedFILE file(base::OpenFile(path, "wb"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to open order file: " << path.value();
+    return false;
+  }
+  core::FileOutStream file_stream(file.get());
+  core::BufferedOutStream out_stream(&file_stream);
+  core::NativeBinaryOutArchive out_archive(&out_stream);
+
+  // Only the sections with blocks are written, as in the JSON format.
+  uint32_t num_sections = 0;
+  SectionSpecVector::const_iterator section_it = sections.begin();
+  for (; section_it != sections.end(); ++section_it) {
+    if (!section_it->blocks.empty())
+      ++num_sections;
+  }
+
+  if (!out_archive.Save(kBinaryOrderMagic) ||
+      !out_archive.Save(kBinaryOrderVersion) ||
+      !metadata.Save(&out_archive) ||
+      !out_archive.Save(comment) ||
+      !out_archive.Save(num_sections)) {
+    return false;
+  }
+
+  for (section_it = sections.begin(); section_it != sections.end();
+       ++section_it) {
+    const SectionSpec& section_spec = *section_it;
+    if (section_spec.blocks.empty())
+      continue;
+
+    uint32_t id = static_cast<uint32_t>(section_spec.id);
+    uint32_t characteristics =
+        static_cast<uint32_t>(section_spec.characteristics);
+    uint32_t num_blocks = static_cast<uint32_t>(section_spec.blocks.size());
+    if (!out_archive.Save(id) ||
+        !out_archive.Save(section_spec.name) ||
+        !out_archive.Save(characteristics) ||
+        !out_archive.Save(num_blocks)) {
+      return false;
+    }
+
+    BlockSpecVector::const_iterator block_it = section_spec.blocks.begin();
+    for (; block_it != section_spec.blocks.end(); ++block_it) {
+      // TODO(rogerm): Flesh out support for synthesizing new blocks.
+      DCHECK(block_it->block != NULL);
+      if (!out_archive.Save(block_it->block->addr().value()) ||
+          !out_archive.Save(block_it->basic_block_offsets)) {
+        return false;
+      }
+    }
+  }
+
+  return out_archive.Flush();
+}
+
+bool Reorderer::Order::LoadFromBinary(const PEFile& pe,
+                                      const ImageLayout& image,
+                                      const base::FilePath& path) {
+  // Read the whole file at once, and parse it from memory.
+  std::string file_string;
+  if (!base::ReadFileToString(path, &file_string)) {
+    LOG(ERROR) << "Unable to read order file to string";
+    return false;
+  }
+  core::ScopedInStreamPtr in_stream(
+      core::CreateByteInStream(file_string.begin(), file_string.end()));
+  core::NativeBinaryInArchive in_archive(in_stream.get());
+
+  // Ensure the metadata is consistent with the signature of the module the
+  // ordering is being applied to.
+  pe::Metadata metadata;
+  PEFile::Signature pe_sig;
+  pe.GetSignature(&pe_sig);
+  if (!LoadBinaryOrderHeader(&in_archive, &metadata))
+    return false;
+  if (!metadata.IsConsistent(pe_sig)) {
+    LOG(ERROR) << "Inconsistent " << kMetadataKey << ".";
+    return false;
+  }
+
+  uint32_t num_sections = 0;
+  if (!in_archive.Load(&comment) || !in_archive.Load(&num_sections)) {
+    LOG(ERROR) << "Unable to read binary order file.";
+    return false;
+  }
+
+  std::set<size_t> seen_section_ids;
+  sections.clear();
+  sections.resize(num_sections);
+  for (size_t i = 0; i < num_sections; ++i) {
+    SectionSpec* section_spec = &sections[i];
+    uint32_t id = 0;
+    std::string name;
+    uint32_t characteristics = 0;
+    uint32_t num_blocks = 0;
+    if (!in_archive.Load(&id) ||
+        !in_archive.Load(&name) ||
+        !in_archive.Load(&characteristics) ||
+        !in_archive.Load(&num_blocks)) {
+      LOG(ERROR) << "Unable to read section #" << i << " of binary order.";
+      return false;
+    }
+
+    // The name and characteristics are always written, and override those
+    // of the original section.
+    section_spec->id = id;
+    if (!ResolveSectionId(image, section_spec, &seen_section_ids))
+      return false;
+    if (name.empty()) {
+      LOG(ERROR) << "Missing a value for the name of section #" << i << ".";
+      return false;
+    }
+    section_spec->name = name;
+    section_spec->characteristics = characteristics;
+
+    section_spec->blocks.resize(num_blocks);
+    for (size_t j = 0; j < num_blocks; ++j) {
+      BlockSpec* block_spec = &section_spec->blocks[j];
+      uint32_t address = 0;
+      if (!in_archive.Load(&address) ||
+          !in_archive.Load(&block_spec->basic_block_offsets)) {
+        LOG(ERROR) << "Unable to read block #" << j << " of section #" << i
+                   << " of binary order.";
+        return false;
+      }
+      if (!ResolveBlockSpec(image, address, block_spec))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool Reorderer::Order::Load(const PEFile& pe,
+                            const ImageLayout& image,
+                            const base::FilePath& path) {
+  if (IsBinaryOrderFile(path))
+    return LoadFromBinary(pe, image, path);
+  return LoadFromJSON(pe, image, path);
+}
+
+bool Reorderer::Order::IsBinaryOrderFile(const base::FilePath& path) {
+  uint32_t magic = 0;
+  int bytes_read = base::ReadFile(path, reinterpret_cast<char*>(&magic),
+                                  sizeof(magic));
+  return bytes_read == sizeof(magic) && magic == kBinaryOrderMagic;
+}
+
 bool Reorderer::Order::GetOriginalModulePath(const base::FilePath& path,
                                              base::FilePath* module) {
+  // Binary order files only need their header to be read.
+  if (IsBinaryOrderFile(path)) {
+    base::ScopedFILE file(base::OpenFile(path, "rb"));
+    if (file.get() == NULL) {
+      LOG(ERROR) << "Unable to open order file: " << path.value();
+      return false;
+    }
+    core::FileInStream file_stream(file.get());
+    core::BufferedInStream in_stream(&file_stream);
+    core::NativeBinaryInArchive in_archive(&in_stream);
+    pe::Metadata metadata;
+    if (!LoadBinaryOrderHeader(&in_archive, &metadata))
+      return false;
+    *module = base::FilePath(metadata.module_signature().path);
+    return true;
+  }
+
   std::string file_string;
   if (!base::ReadFileToString(path, &file_string)) {
     LOG(ERROR) << "Unable to read order file to string.";
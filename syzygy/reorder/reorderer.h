@@ -282,8 +282,32 @@ struct Reorderer::Order {
                     const ImageLayout& image,
                     const base::FilePath& path);
 
-  // Extracts the name of the original module from an order file. This is
-  // used to guess the value of --input-image.
+  // Serializes the order to a compact binary file. Blocks are referred to by
+  // their address in the original image, and their basic-blocks by arrays of
+  // offsets, so the file loads much faster than its JSON counterpart.
+  // @param pe The original image.
+  // @param path The path of the file to write.
+  // @returns true on success, false otherwise.
+  bool SerializeToBinary(const PEFile& pe, const base::FilePath& path) const;
+
+  // Loads an ordering from a binary file, as written by SerializeToBinary.
+  // The file is read in a single pass.
+  // @note @p pe and @p image must already be populated prior to calling this.
+  bool LoadFromBinary(const PEFile& pe,
+                      const ImageLayout& image,
+                      const base::FilePath& path);
+
+  // Loads an ordering from either a JSON or a binary file.
+  // @note @p pe and @p image must already be populated prior to calling this.
+  bool Load(const PEFile& pe,
+            const ImageLayout& image,
+            const base::FilePath& path);
+
+  // @returns true if @p path is a binary order file, false otherwise.
+  static bool IsBinaryOrderFile(const base::FilePath& path);
+
+  // Extracts the name of the original module from an order file, in either
+  // format. This is used to guess the value of --input-image.
   static bool GetOriginalModulePath(const base::FilePath& path,
                                     base::FilePath* module);
 
@@ -324,6 +348,15 @@ class Reorderer::OrderGenerator {
     return true;
   }
 
+  // The derived class may implement this callback, which provides the
+  // environment of a process invoking the instrumented module. This follows
+  // the OnProcessStarted event of the process, when its trace has one.
+  virtual bool OnProcessEnvironment(
+      uint32_t process_id,
+      const TraceEnvironmentStrings& environment) {
+    return true;
+  }
+
   // The derived class shall implement this callback, which receives
   // TRACE_ENTRY events for the module that is being reordered. Returns true
   // on success, false on error. If this returns false, no further callbacks
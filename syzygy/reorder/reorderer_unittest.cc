@@ -469,69 +469,87 @@ TEST(OrderTest, BlockSpecConstructorsAndCopier) {
   EXPECT_TRUE(BlockSpecsAreEqual(copied_block_spec, explicit_block_spec));
 }
 
-TEST(OrderTest, SerializeToJsonRoundTrip) {
-  // Build a dummy block graph.
+namespace {
+
+class OrderSerializationTest : public testing::Test {
+ public:
+  OrderSerializationTest() : layout(&block_graph) {
+  }
+
+  void SetUp() override {
+    // Build a dummy block graph.
+    BlockGraph::Section* section1 = block_graph.AddSection(".text", 0);
+    BlockGraph::Section* section2 = block_graph.AddSection(".rdata", 0);
+    BlockGraph::Block* block1 = block_graph.AddBlock(BlockGraph::CODE_BLOCK, 10,
+                                                     "block1");
+    BlockGraph::Block* block2 = block_graph.AddBlock(BlockGraph::DATA_BLOCK, 10,
+                                                     "block2");
+    BlockGraph::Block* block3 = block_graph.AddBlock(BlockGraph::DATA_BLOCK, 10,
+                                                     "block3");
+    block1->set_section(section1->id());
+    block2->set_section(section2->id());
+    block3->set_section(section2->id());
+
+    // Build a dummy image layout.
+    pe::ImageLayout::SectionInfo section_info1 = {};
+    section_info1.name = section1->name();
+    section_info1.addr = core::RelativeAddress(0x1000);
+    section_info1.size = 0x1000;
+    section_info1.data_size = 0x1000;
+    layout.sections.push_back(section_info1);
+
+    pe::ImageLayout::SectionInfo section_info2 = {};
+    section_info2.name = section2->name();
+    section_info2.addr = core::RelativeAddress(0x2000);
+    section_info2.size = 0x1000;
+    section_info2.data_size = 0x1000;
+    layout.sections.push_back(section_info2);
+
+    layout.blocks.InsertBlock(section_info1.addr,
+                              block1);
+    layout.blocks.InsertBlock(section_info2.addr,
+                              block2);
+    layout.blocks.InsertBlock(section_info2.addr + block2->size(),
+                              block3);
+
+    // Build a dummy order.
+    order.comment = "This is a comment.";
+    order.sections.resize(2);
+    order.sections[0].id = section1->id();
+    order.sections[0].name = section1->name();
+    order.sections[0].characteristics = section1->characteristics();
+    order.sections[0].blocks.push_back(BlockSpec(block1));
+    order.sections[0].blocks.back().basic_block_offsets.push_back(0);
+    order.sections[0].blocks.back().basic_block_offsets.push_back(8);
+    order.sections[1].id = section2->id();
+    order.sections[1].name = section2->name();
+    order.sections[1].characteristics = section2->characteristics();
+    order.sections[1].blocks.push_back(BlockSpec(block2));
+    order.sections[1].blocks.push_back(BlockSpec(block3));
+
+    module = testing::GetExeTestDataRelativePath(testing::kTestDllName);
+    ASSERT_TRUE(pe_file.Init(module));
+    ASSERT_TRUE(base::CreateTemporaryFile(&temp_file));
+  }
+
+  void TearDown() override {
+    EXPECT_TRUE(base::DeleteFile(temp_file, false));
+  }
+
   BlockGraph block_graph;
-  BlockGraph::Section* section1 = block_graph.AddSection(".text", 0);
-  BlockGraph::Section* section2 = block_graph.AddSection(".rdata", 0);
-  BlockGraph::Block* block1 = block_graph.AddBlock(BlockGraph::CODE_BLOCK, 10,
-                                                   "block1");
-  BlockGraph::Block* block2 = block_graph.AddBlock(BlockGraph::DATA_BLOCK, 10,
-                                                   "block2");
-  BlockGraph::Block* block3 = block_graph.AddBlock(BlockGraph::DATA_BLOCK, 10,
-                                                   "block3");
-  block1->set_section(section1->id());
-  block2->set_section(section2->id());
-  block3->set_section(section2->id());
-
-  // Build a dummy image layout.
-  pe::ImageLayout layout(&block_graph);
-  pe::ImageLayout::SectionInfo section_info1 = {};
-  section_info1.name = section1->name();
-  section_info1.addr = core::RelativeAddress(0x1000);
-  section_info1.size = 0x1000;
-  section_info1.data_size = 0x1000;
-  layout.sections.push_back(section_info1);
-
-  pe::ImageLayout::SectionInfo section_info2 = {};
-  section_info2.name = section2->name();
-  section_info2.addr = core::RelativeAddress(0x2000);
-  section_info2.size = 0x1000;
-  section_info2.data_size = 0x1000;
-  layout.sections.push_back(section_info2);
-
-  layout.blocks.InsertBlock(section_info1.addr,
-                            block1);
-  layout.blocks.InsertBlock(section_info2.addr,
-                            block2);
-  layout.blocks.InsertBlock(section_info2.addr + block2->size(),
-                            block3);
-
-  // Build a dummy order.
+  pe::ImageLayout layout;
   Reorderer::Order order;
-  order.comment = "This is a comment.";
-  order.sections.resize(2);
-  order.sections[0].id = section1->id();
-  order.sections[0].name = section1->name();
-  order.sections[0].characteristics = section1->characteristics();
-  order.sections[0].blocks.push_back(BlockSpec(block1));
-  order.sections[0].blocks.back().basic_block_offsets.push_back(0);
-  order.sections[0].blocks.back().basic_block_offsets.push_back(8);
-  order.sections[1].id = section2->id();
-  order.sections[1].name = section2->name();
-  order.sections[1].characteristics = section2->characteristics();
-  order.sections[1].blocks.push_back(BlockSpec(block2));
-  order.sections[1].blocks.push_back(BlockSpec(block3));
-
-  base::FilePath module = testing::GetExeTestDataRelativePath(
-      testing::kTestDllName);
+  base::FilePath module;
   pe::PEFile pe_file;
-  ASSERT_TRUE(pe_file.Init(module));
+  base::FilePath temp_file;
+};
+
+}  // namespace
 
+TEST_F(OrderSerializationTest, SerializeToJsonRoundTrip) {
   // Serialize the order.
-  base::FilePath temp_file;
-  ASSERT_TRUE(base::CreateTemporaryFile(&temp_file));
   EXPECT_TRUE(order.SerializeToJSON(pe_file, temp_file, true));
+  EXPECT_FALSE(Reorderer::Order::IsBinaryOrderFile(temp_file));
 
   // Get the original module from the file.
   base::FilePath orig_module;
@@ -545,8 +563,31 @@ TEST(OrderTest, SerializeToJsonRoundTrip) {
 
   // Expect them to be the same.
   EXPECT_TRUE(OrdersAreEqual(order, order2));
+}
+
+TEST_F(OrderSerializationTest, SerializeToBinaryRoundTrip) {
+  // Serialize the order.
+  EXPECT_TRUE(order.SerializeToBinary(pe_file, temp_file));
+  EXPECT_TRUE(Reorderer::Order::IsBinaryOrderFile(temp_file));
+
+  // Get the original module from the file.
+  base::FilePath orig_module;
+  EXPECT_TRUE(Reorderer::Order::GetOriginalModulePath(temp_file, &orig_module));
+  EXPECT_EQ(module, orig_module);
+
+  // Deserialize it, both explicitly and by sniffing the format.
+  Reorderer::Order order2;
+  EXPECT_FALSE(OrdersAreEqual(order, order2));
+  EXPECT_TRUE(order2.LoadFromBinary(pe_file, layout, temp_file));
+  EXPECT_TRUE(OrdersAreEqual(order, order2));
+
+  Reorderer::Order order3;
+  EXPECT_TRUE(order3.Load(pe_file, layout, temp_file));
+  EXPECT_TRUE(OrdersAreEqual(order, order3));
 
-  EXPECT_TRUE(base::DeleteFile(temp_file, false));
+  // A binary file isn't valid JSON.
+  Reorderer::Order order4;
+  EXPECT_FALSE(order4.LoadFromJSON(pe_file, layout, temp_file));
 }
 
 }  // namespace reorder
@@ -73,7 +73,7 @@ class SampledModuleCache {
     kProfilingContinued,
   };
 
-  typedef std::map<WORD, Process*> ProcessMap;
+  typedef std::map<DWORD, Process*> ProcessMap;
 
   // This is the callback that is used to indicate that a module has been
   // unloaded and/or we have stopped profiling it (from our point of view, it is
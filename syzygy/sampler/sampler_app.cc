@@ -51,6 +51,12 @@ const char kUsageFormatStr[] =
     "                        the list is a whitelist.\n"
     "  --bucket-size=POSINT  Specifies the bucket size. This must be a power\n"
     "                        of two, and must be >= 4. Defaults to 4.\n"
+    "  --flush-interval=INTERVAL\n"
+    "                        The interval at which collected samples are\n"
+    "                        written to the trace files. This is a floating\n"
+    "                        point value in seconds. A value of zero means\n"
+    "                        samples are only written when a module is\n"
+    "                        unloaded or the sampler exits. Defaults to 30.\n"
     "  --output-dir=DIR      The path to write trace-files. Will be created\n"
     "                        if it doesn't exist. Defaults to the current\n"
     "                        working directory.\n"
@@ -140,6 +146,34 @@ bool ParseSamplingInterval(const base::CommandLine* command_line,
   return true;
 }
 
+// Parses the flush interval. Leaves the value unchanged if it is not
+// specified.
+bool ParseFlushInterval(const base::CommandLine* command_line,
+                        base::TimeDelta* flush_interval) {
+  DCHECK(command_line != NULL);
+  DCHECK(flush_interval != NULL);
+
+  if (!command_line->HasSwitch(SamplerApp::kFlushInterval))
+    return true;
+
+  std::string s = command_line->GetSwitchValueASCII(
+      SamplerApp::kFlushInterval);
+  double d = 0;
+  if (!base::StringToDouble(s, &d)) {
+    LOG(ERROR) << "--" << SamplerApp::kFlushInterval << " must be a double.";
+    return false;
+  }
+  if (d < 0) {
+    LOG(ERROR) << "--" << SamplerApp::kFlushInterval
+               << " must not be negative.";
+    return false;
+  }
+
+  *flush_interval = base::TimeDelta::FromMicroseconds(
+      static_cast<int64_t>(1000000 * d));
+  return true;
+}
+
 // A utility function for converting a time delta to a human readable string.
 const std::string TimeDeltaToString(const base::TimeDelta& td) {
   // Aliases to constants from base::Time (which have overly long names).
@@ -394,12 +428,16 @@ typedef base::Callback<void (const SampledModuleCache::Module*)>
 
 // Attaches to the running process with the specified PID and iterates over
 // its modules. If any of them is found in the list of modules to be profiled
-// adds the process/module pair to the sample module cache.
+// adds the process/module pair to the sample module cache. Only modules that
+// aren't already in @p inspected have their signatures read from the process;
+// on return @p inspected contains exactly the modules currently loaded.
 bool InspectProcessModules(DWORD pid,
                            SamplerApp::ModuleSignatureSet& module_sigs,
                            StartProfilingCallback callback,
+                           std::map<HMODULE, bool>* inspected,
                            SampledModuleCache* cache) {
   DCHECK(!callback.is_null());
+  DCHECK(inspected != NULL);
   DCHECK(cache != NULL);
 
   base::win::ScopedHandle handle;
@@ -418,14 +456,26 @@ bool InspectProcessModules(DWORD pid,
   if (!GetProcessModules(handle.Get(), &modules))
     return false;
 
-  // Iterate over the modules in the process.
+  // Iterate over the modules in the process. Modules that have been unloaded
+  // since the last inspection are dropped from |inspected|, so a different
+  // module loaded at the same address is only missed if the swap happens
+  // between two polls.
+  std::map<HMODULE, bool> loaded;
   for (size_t i = 0; i < modules.size(); ++i) {
-    SamplerApp::ModuleSignature module_sig = {};
-    if (!GetModuleSignature(handle.Get(), modules[i], &module_sig))
-      return false;
+    std::map<HMODULE, bool>::const_iterator it = inspected->find(modules[i]);
+    bool interesting = false;
+    if (it != inspected->end()) {
+      interesting = it->second;
+    } else {
+      SamplerApp::ModuleSignature module_sig = {};
+      if (!GetModuleSignature(handle.Get(), modules[i], &module_sig))
+        return false;
+      interesting = module_sigs.find(module_sig) != module_sigs.end();
+    }
+    loaded[modules[i]] = interesting;
 
     // Skip over this module if its not in the set of modules of interest.
-    if (module_sigs.find(module_sig) == module_sigs.end())
+    if (!interesting)
       continue;
 
     // Add this module to the list of those being profiled.
@@ -441,6 +491,7 @@ bool InspectProcessModules(DWORD pid,
       callback.Run(module);
   }
 
+  inspected->swap(loaded);
   return true;
 }
 
@@ -525,17 +576,25 @@ bool WriteTraceModuleDataRecord(const SampledModuleCache::Module* module,
   return true;
 }
 
-// Converts the sample data in |module| to a TraceSampleData buffer and outputs
-// it to the provided TraceFileWriter.
+// Converts the sample data gathered by |module| since the last flush to a
+// TraceSampleData buffer and outputs it to the provided TraceFileWriter. The
+// bucket values as of the last flush are in |flushed_buckets|, which is updated
+// to the current values. Consumers of the trace file sum up the records of a
+// module, so writing the differences is equivalent to writing the totals once.
 bool WriteTraceSampleDataRecord(uint64_t sampling_interval_in_cycles,
                                 const SampledModuleCache::Module* module,
+                                uint64_t start_time,
+                                uint64_t stop_time,
+                                std::vector<ULONG>* flushed_buckets,
                                 TraceFileWriter* writer) {
   DCHECK(module != NULL);
+  DCHECK(flushed_buckets != NULL);
   DCHECK(writer != NULL);
 
   const ULONG* buckets = module->profiler().buckets().data();
   size_t bucket_count = module->profiler().buckets().size();
   DCHECK_LT(0u, bucket_count);
+  DCHECK_EQ(bucket_count, flushed_buckets->size());
 
   // Calculate the size of the buffer required to store the samples.
   size_t size = offsetof(TraceSampleData, buckets) +
@@ -555,12 +614,17 @@ bool WriteTraceSampleDataRecord(uint64_t sampling_interval_in_cycles,
   data->bucket_size = 1 << module->log2_bucket_size();
   data->bucket_start = reinterpret_cast<ModuleAddr>(module->buckets_begin());
   data->bucket_count = bucket_count;
-  data->sampling_start_time = module->profiling_start_time();
-  data->sampling_end_time = module->profiling_stop_time();
+  data->sampling_start_time = start_time;
+  data->sampling_end_time = stop_time;
   data->sampling_interval = sampling_interval_in_cycles;
 
-  // Copy the samples into the buffer.
-  ::memcpy(data->buckets, buckets, sizeof(buckets[0]) * bucket_count);
+  // Copy the new samples into the buffer. The buckets may still be updating
+  // on other cores, so each is read exactly once.
+  for (size_t i = 0; i < bucket_count; ++i) {
+    ULONG value = buckets[i];
+    data->buckets[i] = value - (*flushed_buckets)[i];
+    (*flushed_buckets)[i] = value;
+  }
 
   if (!WriteTraceRecord(data, size, TRACE_SAMPLE_DATA, writer))
     return false;
@@ -572,11 +636,14 @@ bool WriteTraceSampleDataRecord(uint64_t sampling_interval_in_cycles,
 
 const char SamplerApp::kBlacklistPids[] = "blacklist-pids";
 const char SamplerApp::kBucketSize[] = "bucket-size";
+const char SamplerApp::kFlushInterval[] = "flush-interval";
 const char SamplerApp::kPids[] = "pids";
 const char SamplerApp::kSamplingInterval[] = "sampling-interval";
 const char SamplerApp::kOutputDir[] = "output-dir";
 
 const size_t SamplerApp::kDefaultLog2BucketSize = 2;
+const base::TimeDelta SamplerApp::kDefaultFlushInterval =
+    base::TimeDelta::FromSeconds(30);
 
 base::Lock SamplerApp::console_ctrl_lock_;
 SamplerApp* SamplerApp::console_ctrl_owner_ = NULL;
@@ -586,6 +653,7 @@ SamplerApp::SamplerApp()
       blacklist_pids_(true),
       log2_bucket_size_(kDefaultLog2BucketSize),
       sampling_interval_(),
+      flush_interval_(kDefaultFlushInterval),
       running_(true),
       sampling_interval_in_cycles_(0) {
 }
@@ -601,7 +669,8 @@ bool SamplerApp::ParseCommandLine(const base::CommandLine* command_line) {
 
   // Parse the profiler parameters.
   if (!ParseBucketSize(command_line, &log2_bucket_size_) ||
-      !ParseSamplingInterval(command_line, &sampling_interval_)) {
+      !ParseSamplingInterval(command_line, &sampling_interval_) ||
+      !ParseFlushInterval(command_line, &flush_interval_)) {
     return PrintUsage(command_line->GetProgram(), "");
   }
 
@@ -702,6 +771,8 @@ int SamplerApp::RunImpl() {
   size_t process_count = 0;
   size_t module_count = 0;
 
+  base::TimeTicks last_flush = base::TimeTicks::Now();
+
   // Sit in a loop, actively monitoring running processes.
   while (running()) {
     // Mark all profiling module as dead. If they aren't remarked as alive after
@@ -719,6 +790,10 @@ int SamplerApp::RunImpl() {
     // in every iteration here.
     PidSet filtered_pids;
 
+    // Likewise the inspected modules of processes that are no longer running
+    // are dropped.
+    ProcessModuleInterestMap inspected_modules;
+
     // Iterate over the processes.
     for (size_t i = 0; i < pids.size(); ++i) {
       DWORD pid = pids[i];
@@ -751,14 +826,28 @@ int SamplerApp::RunImpl() {
       // If we get here the process corresponding to this PID needs to be
       // examined.
       StartProfilingCallback callback = base::Bind(
-          &SamplerApp::OnStartProfiling, base::Unretained(this));
-      if (!InspectProcessModules(pid, module_sigs_, callback, &cache))
+          &SamplerApp::OnStartModule, base::Unretained(this));
+      ModuleInterestMap& inspected = inspected_modules[pid];
+      inspected.swap(inspected_modules_[pid]);
+      if (!InspectProcessModules(pid, module_sigs_, callback, &inspected,
+                                 &cache)) {
         return 1;
+      }
     }
+    inspected_modules_.swap(inspected_modules);
 
     // Remove any profiled modules that are 'dead'. This invokes the callback
-    // and causes the profile information to be written to a trace file.
+    // and causes the remaining profile information to be written to the trace
+    // file of the process.
     cache.RemoveDeadModules();
+    CloseDeadTraceFiles(cache);
+
+    // Stream the samples collected so far to the trace files.
+    if (!flush_interval_.is_zero() &&
+        base::TimeTicks::Now() - last_flush >= flush_interval_) {
+      FlushModules(cache);
+      last_flush = base::TimeTicks::Now();
+    }
 
     // Count the number of actively profiled modules and processes.
     size_t new_process_count = cache.processes().size();
@@ -787,6 +876,7 @@ int SamplerApp::RunImpl() {
   // progress profiling data.
   cache.MarkAllModulesDead();
   cache.RemoveDeadModules();
+  CloseDeadTraceFiles(cache);
 
   return 0;
 }
@@ -828,42 +918,104 @@ bool SamplerApp::ParsePids(const std::string& pids) {
   return true;
 }
 
-void SamplerApp::OnDeadModule(const SampledModuleCache::Module* module) {
+void SamplerApp::OnStartModule(const SampledModuleCache::Module* module) {
   DCHECK(module != NULL);
 
-  // Invoke our testing seam callback.
-  OnStopProfiling(module);
-
   const SampledModuleCache::Process* process = module->process();
   DCHECK(process != NULL);
 
-  base::FilePath basename = TraceFileWriter::GenerateTraceFileBaseName(
-          process->process_info());
-  base::FilePath trace_file_path = output_dir_.Append(basename);
+  FlushState& flush_state = flush_states_[module];
+  flush_state.buckets.resize(module->profiler().buckets().size());
+  flush_state.time = module->profiling_start_time();
+
+  // Open the trace file for the process if this is its first profiled module.
+  TraceFileWriter* writer = NULL;
+  TraceFileWriterMap::iterator writer_it =
+      trace_file_writers_.find(process->pid());
+  if (writer_it != trace_file_writers_.end()) {
+    writer = writer_it->second.get();
+  } else {
+    base::FilePath basename = TraceFileWriter::GenerateTraceFileBaseName(
+        process->process_info());
+    base::FilePath trace_file_path = output_dir_.Append(basename);
+
+    LOG(INFO) << "Writing module samples to \"" << trace_file_path.value()
+              << "\".";
+
+    std::unique_ptr<TraceFileWriter> new_writer(new TraceFileWriter());
+    if (new_writer->Open(trace_file_path) &&
+        new_writer->WriteHeader(process->process_info())) {
+      writer = new_writer.get();
+      trace_file_writers_[process->pid()].swap(new_writer);
+    }
+  }
+
+  if (writer != NULL)
+    WriteTraceModuleDataRecord(module, writer);
+
+  // Invoke our testing seam callback.
+  OnStartProfiling(module);
+}
+
+void SamplerApp::OnDeadModule(const SampledModuleCache::Module* module) {
+  DCHECK(module != NULL);
+
+  // Invoke our testing seam callback.
+  OnStopProfiling(module);
 
-  LOG(INFO) << "Writing module samples to \"" << trace_file_path.value()
-            << "\".";
+  FlushModule(module, module->profiling_stop_time());
+  flush_states_.erase(module);
+}
 
-  // TODO(chrisha): If we deal with processes with multiple profiled modules
-  //     or repeatedly loaded and unloaded modules, we could persist a trace
-  //     file writer for each process and use it repeatedly.
+void SamplerApp::FlushModules(const SampledModuleCache& cache) {
+  uint64_t now = trace::common::GetTsc();
+  SampledModuleCache::ProcessMap::const_iterator proc_it =
+      cache.processes().begin();
+  for (; proc_it != cache.processes().end(); ++proc_it) {
+    const SampledModuleCache::Process::ModuleMap& modules =
+        proc_it->second->modules();
+    SampledModuleCache::Process::ModuleMap::const_iterator mod_it =
+        modules.begin();
+    for (; mod_it != modules.end(); ++mod_it)
+      FlushModule(mod_it->second, now);
+  }
+}
 
-  TraceFileWriter writer;
-  if (!writer.Open(trace_file_path))
-    return;
+bool SamplerApp::FlushModule(const SampledModuleCache::Module* module,
+                             uint64_t stop_time) {
+  DCHECK(module != NULL);
 
-  if (!writer.WriteHeader(process->process_info()))
-    return;
+  FlushStateMap::iterator state_it = flush_states_.find(module);
+  if (state_it == flush_states_.end())
+    return false;
 
-  if (!WriteTraceModuleDataRecord(module, &writer))
-    return;
+  TraceFileWriterMap::iterator writer_it =
+      trace_file_writers_.find(module->process()->pid());
+  if (writer_it == trace_file_writers_.end())
+    return false;
 
+  FlushState& flush_state = state_it->second;
   if (!WriteTraceSampleDataRecord(sampling_interval_in_cycles_, module,
-                                  &writer)) {
-    return;
+                                  flush_state.time, stop_time,
+                                  &flush_state.buckets,
+                                  writer_it->second.get())) {
+    return false;
   }
+  flush_state.time = stop_time;
+
+  return true;
+}
 
-  return;
+void SamplerApp::CloseDeadTraceFiles(const SampledModuleCache& cache) {
+  TraceFileWriterMap::iterator it = trace_file_writers_.begin();
+  while (it != trace_file_writers_.end()) {
+    if (cache.processes().find(it->first) != cache.processes().end()) {
+      ++it;
+      continue;
+    }
+    it->second->Close();
+    it = trace_file_writers_.erase(it);
+  }
 }
 
 bool SamplerApp::GetModuleSignature(
@@ -18,18 +18,24 @@
 #ifndef SYZYGY_SAMPLER_SAMPLER_APP_H_
 #define SYZYGY_SAMPLER_SAMPLER_APP_H_
 
+#include <map>
+#include <memory>
 #include <set>
+#include <vector>
 
 #include "base/files/file_path.h"
 #include "base/time/time.h"
 #include "syzygy/application/application.h"
 #include "syzygy/sampler/sampled_module_cache.h"
+#include "syzygy/trace/service/trace_file_writer.h"
 
 namespace sampler {
 
 // The application class that takes care of running a profiling sampler. This
 // works by polling running processes and attaching a SamplingProfiler instance
 // to every module of interest. The output is then shuttled to trace data files.
+// Each profiled process gets a single trace file, to which sample data is
+// streamed incrementally as it is collected.
 class SamplerApp : public application::AppImplBase {
  public:
   SamplerApp();
@@ -45,6 +51,7 @@ class SamplerApp : public application::AppImplBase {
   // @{
   static const char kBlacklistPids[];
   static const char kBucketSize[];
+  static const char kFlushInterval[];
   static const char kPids[];
   static const char kSamplingInterval[];
   static const char kOutputDir[];
@@ -53,6 +60,7 @@ class SamplerApp : public application::AppImplBase {
   // @name Default command-line values.
   // @{
   static const size_t kDefaultLog2BucketSize;
+  static const base::TimeDelta kDefaultFlushInterval;
   // @}
 
   // These are exposed for use by anonymous helper functions.
@@ -82,11 +90,33 @@ class SamplerApp : public application::AppImplBase {
   // @returns true on success, false otherwise.
   bool ParsePids(const std::string& pids);
 
+  // The callback that is invoked for modules as we start profiling them. This
+  // opens the trace file of the owning process if necessary and writes the
+  // module record to it.
+  // @param module The module that has just started profiling.
+  void OnStartModule(const SampledModuleCache::Module* module);
+
   // The callback that is invoked for modules once we have finished profiling
-  // them.
+  // them. This writes any samples not yet flushed to the trace file.
   // @param module The module that has just finished profiling.
   void OnDeadModule(const SampledModuleCache::Module* module);
 
+  // Writes the samples gathered since the last flush for all profiled modules
+  // to their trace files.
+  // @param cache The cache containing the modules being profiled.
+  void FlushModules(const SampledModuleCache& cache);
+
+  // Writes the samples gathered by @p module since its last flush.
+  // @param module The module whose samples are to be written.
+  // @param stop_time The timestamp up to which the samples were gathered.
+  // @returns true on success, false otherwise.
+  bool FlushModule(const SampledModuleCache::Module* module,
+                   uint64_t stop_time);
+
+  // Closes the trace files of processes that are no longer being profiled.
+  // @param cache The cache containing the processes being profiled.
+  void CloseDeadTraceFiles(const SampledModuleCache& cache);
+
   // Initializes a ModuleSignature given a path. Logs an error on failure.
   // @param module The path to the module.
   // @param sig The signature object to be initialized.
@@ -118,6 +148,10 @@ class SamplerApp : public application::AppImplBase {
   size_t log2_bucket_size_;
   base::TimeDelta sampling_interval_;
 
+  // The interval at which sample data is streamed to the trace files. If this
+  // is zero then samples are only written when profiling of a module stops.
+  base::TimeDelta flush_interval_;
+
   // The output directory where trace files will be written.
   base::FilePath output_dir_;
 
@@ -135,6 +169,27 @@ class SamplerApp : public application::AppImplBase {
   uint64_t sampling_interval_in_cycles_;
   // @}
 
+  // The open trace file of each process being profiled, keyed by PID.
+  typedef std::map<DWORD, std::unique_ptr<trace::service::TraceFileWriter>>
+      TraceFileWriterMap;
+  TraceFileWriterMap trace_file_writers_;
+
+  // The bucket values and timestamp as of the last flush of each profiled
+  // module. Only the difference is written to the trace file on each flush.
+  struct FlushState {
+    std::vector<ULONG> buckets;
+    uint64_t time;
+  };
+  typedef std::map<const SampledModuleCache::Module*, FlushState> FlushStateMap;
+  FlushStateMap flush_states_;
+
+  // The modules that have already been inspected in each process, keyed by
+  // PID. The value indicates whether the module is one of interest. This saves
+  // reading the headers of every module of every process on every poll.
+  typedef std::map<HMODULE, bool> ModuleInterestMap;
+  typedef std::map<DWORD, ModuleInterestMap> ProcessModuleInterestMap;
+  ProcessModuleInterestMap inspected_modules_;
+
   // Only one instance of this class can register for console control messages,
   // on a first-come first-serve basis.
   static base::Lock console_ctrl_lock_;
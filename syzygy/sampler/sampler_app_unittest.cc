@@ -60,6 +60,7 @@ class TestSamplerApp : public SamplerApp {
   using SamplerApp::module_sigs_;
   using SamplerApp::log2_bucket_size_;
   using SamplerApp::sampling_interval_;
+  using SamplerApp::flush_interval_;
   using SamplerApp::running_;
 
   void WaitUntilStartProfiling() {
@@ -302,6 +303,7 @@ TEST_F(SamplerAppTest, ParseValidBucketSizeMinimal) {
   EXPECT_THAT(impl_.module_sigs_, testing::ElementsAre(test_dll_sig));
   EXPECT_EQ(3u, impl_.log2_bucket_size_);
   EXPECT_EQ(kDefaultSamplingInterval, impl_.sampling_interval_);
+  EXPECT_EQ(SamplerApp::kDefaultFlushInterval, impl_.flush_interval_);
   EXPECT_TRUE(impl_.output_dir_.empty());
 }
 
@@ -356,6 +358,32 @@ TEST_F(SamplerAppTest, ParseValidSamplingIntervalScientific) {
   EXPECT_TRUE(impl_.output_dir_.empty());
 }
 
+TEST_F(SamplerAppTest, ParseNegativeFlushIntervalFails) {
+  cmd_line_.AppendSwitchASCII(TestSamplerApp::kFlushInterval, "-1");
+  cmd_line_.AppendArgPath(test_dll_path);
+  EXPECT_FALSE(impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(SamplerAppTest, ParseInvalidFlushIntervalFails) {
+  cmd_line_.AppendSwitchASCII(TestSamplerApp::kFlushInterval, "foo");
+  cmd_line_.AppendArgPath(test_dll_path);
+  EXPECT_FALSE(impl_.ParseCommandLine(&cmd_line_));
+}
+
+TEST_F(SamplerAppTest, ParseValidFlushInterval) {
+  cmd_line_.AppendSwitchASCII(TestSamplerApp::kFlushInterval, "2.5");
+  cmd_line_.AppendArgPath(test_dll_path);
+  ASSERT_TRUE(impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(2500), impl_.flush_interval_);
+}
+
+TEST_F(SamplerAppTest, ParseZeroFlushInterval) {
+  cmd_line_.AppendSwitchASCII(TestSamplerApp::kFlushInterval, "0");
+  cmd_line_.AppendArgPath(test_dll_path);
+  ASSERT_TRUE(impl_.ParseCommandLine(&cmd_line_));
+  EXPECT_TRUE(impl_.flush_interval_.is_zero());
+}
+
 TEST_F(SamplerAppTest, ParseOutputDir) {
   cmd_line_.AppendSwitchASCII(TestSamplerApp::kOutputDir, "foo");
   cmd_line_.AppendArgPath(test_dll_path);
@@ -23,7 +23,87 @@ HeatMapSimulation::HeatMapSimulation()
       memory_slice_bytes_(kDefaultMemorySliceSize),
       max_time_slice_usecs_(0),
       max_memory_slice_bytes_(0),
-      output_individual_functions_(false) {
+      output_individual_functions_(false),
+      flush_lag_slices_(kDefaultFlushLagSlices),
+      sample_period_(1),
+      entry_count_(0),
+      function_buckets_(false),
+      stream_(NULL),
+      stream_failed_(false) {
+}
+
+bool HeatMapSimulation::StartStreaming(FILE* stream) {
+  DCHECK(stream != NULL);
+  DCHECK(stream_ == NULL);
+  DCHECK(time_memory_map_.empty());
+
+  stream_ = stream;
+  stream_failed_ = false;
+  StreamHeader header = {};
+  header.magic = StreamHeader::kMagic;
+  header.version = StreamHeader::kVersion;
+  header.time_slice_usecs = time_slice_usecs_;
+  header.memory_slice_bytes = memory_slice_bytes_;
+  header.sample_period = sample_period_;
+  header.function_buckets = function_buckets_ ? 1 : 0;
+  WriteToStream(&header, sizeof(header));
+
+  return !stream_failed_;
+}
+
+bool HeatMapSimulation::FinishStreaming() {
+  DCHECK(stream_ != NULL);
+
+  if (!time_memory_map_.empty())
+    FlushTimeSlices(time_memory_map_.rbegin()->first + 1);
+  if (!stream_failed_ && ::fflush(stream_) != 0) {
+    LOG(ERROR) << "Failed to flush the heat map stream.";
+    stream_failed_ = true;
+  }
+  stream_ = NULL;
+  streamed_buckets_.clear();
+
+  return !stream_failed_;
+}
+
+void HeatMapSimulation::FlushTimeSlices(TimeSliceId end) {
+  DCHECK(stream_ != NULL);
+
+  while (!time_memory_map_.empty() && time_memory_map_.begin()->first < end) {
+    TimeMemoryMap::iterator time_memory_iter = time_memory_map_.begin();
+    const TimeSlice::MemorySliceMap& slices =
+        time_memory_iter->second.slices();
+
+    uint32_t record_type = kTimeSliceRecord;
+    int64_t time_slice = time_memory_iter->first;
+    uint32_t slice_count = static_cast<uint32_t>(slices.size());
+    WriteToStream(&record_type, sizeof(record_type));
+    WriteToStream(&time_slice, sizeof(time_slice));
+    WriteToStream(&slice_count, sizeof(slice_count));
+
+    TimeSlice::MemorySliceMap::const_iterator slices_iter = slices.begin();
+    for (; slices_iter != slices.end(); ++slices_iter) {
+      uint32_t slice = slices_iter->first;
+      uint32_t quantity = slices_iter->second.total;
+      WriteToStream(&slice, sizeof(slice));
+      WriteToStream(&quantity, sizeof(quantity));
+    }
+
+    time_memory_map_.erase(time_memory_iter);
+  }
+}
+
+void HeatMapSimulation::WriteToStream(const void* data, size_t size) {
+  DCHECK(stream_ != NULL);
+  DCHECK(data != NULL);
+
+  // Only report the first failure.
+  if (stream_failed_)
+    return;
+  if (::fwrite(data, 1, size, stream_) != size) {
+    LOG(ERROR) << "Failed to write to the heat map stream.";
+    stream_failed_ = true;
+  }
 }
 
 bool HeatMapSimulation::TimeSlice::PrintJSONFunctions(
@@ -140,6 +220,16 @@ void HeatMapSimulation::OnProcessStarted(base::Time time,
 
 void HeatMapSimulation::OnFunctionEntry(base::Time time,
                                         const Block* block) {
+  DCHECK(block != NULL);
+
+  // Only symbolized functions have a bucket.
+  if (function_buckets_ && block->name().empty())
+    return;
+
+  // Downsample the entries. The ones that are kept stand for the others.
+  if (entry_count_++ % sample_period_ != 0)
+    return;
+
   // Get the time when this function was called since the process start.
   time_t relative_time = (time - process_start_time_).InMicroseconds();
 
@@ -153,17 +243,46 @@ void HeatMapSimulation::OnFunctionEntry(base::Time time,
 
   max_time_slice_usecs_ = std::max(max_time_slice_usecs_, time_slice);
 
-  DCHECK(block != NULL);
   DCHECK(memory_slice_bytes_ != 0);
   const uint32_t block_start = block->addr().value();
   const uint32_t size = block->size();
   const std::string& name = block->name();
 
+  if (function_buckets_) {
+    // The whole function goes to its bucket.
+    const MemorySliceId bucket = block->id();
+    slice.AddSlice(bucket, name, size * sample_period_);
+    max_memory_slice_bytes_ = std::max(max_memory_slice_bytes_, bucket);
+
+    // Name the bucket in the stream the first time it's used.
+    if (stream_ != NULL && streamed_buckets_.insert(bucket).second) {
+      uint32_t record_type = kBucketNameRecord;
+      uint32_t length = static_cast<uint32_t>(name.size());
+      WriteToStream(&record_type, sizeof(record_type));
+      WriteToStream(&bucket, sizeof(bucket));
+      WriteToStream(&length, sizeof(length));
+      WriteToStream(name.data(), name.size());
+    }
+  } else {
+    AddBlockSlices(block_start, size, name, &slice);
+  }
+
+  if (stream_ != NULL)
+    FlushTimeSlices(time_slice - flush_lag_slices_);
+}
+
+void HeatMapSimulation::AddBlockSlices(uint32_t block_start,
+                                       uint32_t size,
+                                       const std::string& name,
+                                       TimeSlice* time_slice) {
+  DCHECK(time_slice != NULL);
+  TimeSlice& slice = *time_slice;
+
   const uint32_t first_slice = block_start / memory_slice_bytes_;
   const uint32_t last_slice = (block_start + size - 1) / memory_slice_bytes_;
   if (first_slice == last_slice) {
     // This function fits in a single memory slice. Add it to our time slice.
-    slice.AddSlice(first_slice, name, size);
+    slice.AddSlice(first_slice, name, size * sample_period_);
   } else {
     // This function takes several memory slices. Add the first and last
     // slices to our time slice only with the part of the slice they use,
@@ -175,14 +294,14 @@ void HeatMapSimulation::OnFunctionEntry(base::Time time,
         ((block_start + size - 1 + memory_slice_bytes_) % memory_slice_bytes_) +
         1;
 
-    slice.AddSlice(first_slice, name, leading_bytes);
-    slice.AddSlice(last_slice, name, trailing_bytes);
+    slice.AddSlice(first_slice, name, leading_bytes * sample_period_);
+    slice.AddSlice(last_slice, name, trailing_bytes * sample_period_);
 
     const uint32_t kStartIndex = block_start / memory_slice_bytes_ + 1;
     const uint32_t kEndIndex = (block_start + size - 1) / memory_slice_bytes_;
 
     for (uint32_t i = kStartIndex; i < kEndIndex; i++)
-      slice.AddSlice(i, name, memory_slice_bytes_);
+      slice.AddSlice(i, name, memory_slice_bytes_ * sample_period_);
   }
 
   max_memory_slice_bytes_ = std::max(max_memory_slice_bytes_, last_slice);
@@ -19,6 +19,7 @@
 #define SYZYGY_SIMULATE_HEAT_MAP_SIMULATION_H_
 
 #include <map>
+#include <set>
 
 #include "base/strings/string_piece.h"
 #include "syzygy/core/json_file_writer.h"
@@ -44,6 +45,27 @@ namespace simulate {
 //
 // If the time slice size or the memory slice size are not set, the default
 // values of 1 and 0x8000, respectively, are used.
+//
+// For long traces, the heat map can be streamed instead of being kept whole
+// in memory. Once StartStreaming is called, each time slice more than
+// flush_lag_slices behind the latest one is written to the stream in a
+// compact binary form, and dropped. Entries arriving late for a time slice
+// that was already written start a new record for it: the records of a time
+// slice add up. FinishStreaming writes the remaining time slices. The stream
+// consists of a StreamHeader followed by records, each one starting with its
+// StreamRecordType:
+//
+//   kTimeSliceRecord: the time slice id (int64_t), the number of memory
+//       slices (uint32_t), then the id and the quantity of each memory slice
+//       (uint32_t each).
+//   kBucketNameRecord: the id of a function bucket (uint32_t), the length of
+//       its name (uint32_t), then the name, not null-terminated.
+//
+// The entries can also be downsampled: with a sample period of N, only one
+// of every N function entries is simulated, with N times its weight. Finally,
+// the memory slices can be replaced by function buckets, one for each
+// symbolized function, i.e. each code block with a name. The id of a bucket
+// is the id of its block, and unnamed blocks are ignored.
 class HeatMapSimulation : public SimulationEventHandler {
  public:
   class TimeSlice;
@@ -57,6 +79,31 @@ class HeatMapSimulation : public SimulationEventHandler {
   static const uint32_t kDefaultTimeSliceSize = 1;
   static const uint32_t kDefaultMemorySliceSize = 0x8000;
 
+  // The default number of time slices kept in memory behind the latest one
+  // when streaming.
+  static const uint32_t kDefaultFlushLagSlices = 16;
+
+  // The header of a stream.
+  struct StreamHeader {
+    // The magic number and version of the stream format.
+    static const uint32_t kMagic = 0x504D5448;  // 'HTMP'.
+    static const uint32_t kVersion = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t time_slice_usecs;
+    uint32_t memory_slice_bytes;
+    uint32_t sample_period;
+    // Non-zero if the memory slices are function buckets.
+    uint32_t function_buckets;
+  };
+
+  // The types of the records of a stream.
+  enum StreamRecordType : uint32_t {
+    kTimeSliceRecord = 1,
+    kBucketNameRecord = 2,
+  };
+
   // Construct a new HeatMapSimulation instance.
   HeatMapSimulation();
 
@@ -69,6 +116,9 @@ class HeatMapSimulation : public SimulationEventHandler {
   MemorySliceId max_memory_slice_bytes() const {
     return max_memory_slice_bytes_;
   }
+  uint32_t flush_lag_slices() const { return flush_lag_slices_; }
+  uint32_t sample_period() const { return sample_period_; }
+  bool function_buckets() const { return function_buckets_; }
   // @}
 
   // @name Mutators.
@@ -92,6 +142,37 @@ class HeatMapSimulation : public SimulationEventHandler {
   void set_output_individual_functions(bool output_individual_functions) {
     output_individual_functions_ = output_individual_functions;
   }
+  // Set the number of time slices kept in memory behind the latest one when
+  // streaming.
+  // @param flush_lag_slices The number of time slices.
+  void set_flush_lag_slices(uint32_t flush_lag_slices) {
+    flush_lag_slices_ = flush_lag_slices;
+  }
+  // Set the downsampling of the function entries.
+  // @param sample_period One of every sample_period entries is simulated.
+  void set_sample_period(uint32_t sample_period) {
+    DCHECK_LT(0u, sample_period);
+    sample_period_ = sample_period;
+  }
+  // Set whether the memory slices are replaced by function buckets.
+  // @param function_buckets true for function buckets, false otherwise.
+  void set_function_buckets(bool function_buckets) {
+    function_buckets_ = function_buckets;
+  }
+  // @}
+
+  // @name Streaming.
+  // @{
+  // Starts streaming the heat map. This must be called before the first
+  // function entry, once the simulation is configured.
+  // @param stream The binary file receiving the heat map. It must outlive
+  //     the simulation, or the call to FinishStreaming.
+  // @returns true on success, false on failure.
+  bool StartStreaming(FILE* stream);
+
+  // Writes the remaining time slices to the stream, and stops streaming.
+  // @returns true if the whole stream was written, false otherwise.
+  bool FinishStreaming();
   // @}
 
   // @name SimulationEventHandler implementation
@@ -178,6 +259,26 @@ class HeatMapSimulation : public SimulationEventHandler {
   // @}
 
  protected:
+  // Adds the memory slices covered by a code block to a time slice.
+  // @param block_start The start of the block.
+  // @param size The size of the block.
+  // @param name The name of the block.
+  // @param time_slice The time slice.
+  void AddBlockSlices(uint32_t block_start,
+                      uint32_t size,
+                      const std::string& name,
+                      TimeSlice* time_slice);
+
+  // Writes the time slices preceding a time slice to the stream, and drops
+  // them.
+  // @param end The first time slice to keep.
+  void FlushTimeSlices(TimeSliceId end);
+
+  // Writes a value to the stream.
+  // @param data The value.
+  // @param size The size of the value, in bytes.
+  void WriteToStream(const void* data, size_t size);
+
   // The size of each time block on the heat map, in microseconds.
   uint32_t time_slice_usecs_;
 
@@ -201,6 +302,25 @@ class HeatMapSimulation : public SimulationEventHandler {
   // in each time/memory block. This gives more information and is useful
   // for analysis, but may make the output files excessively big.
   bool output_individual_functions_;
+
+  // The number of time slices kept in memory behind the latest one when
+  // streaming.
+  uint32_t flush_lag_slices_;
+
+  // One of every sample_period_ function entries is simulated. The number of
+  // entries seen so far is counted to pick them.
+  uint32_t sample_period_;
+  uint64_t entry_count_;
+
+  // If true, the memory slices are function buckets.
+  bool function_buckets_;
+
+  // The stream receiving the heat map, or NULL if it isn't streamed. The
+  // buckets whose names were written to the stream, and whether a write to
+  // the stream failed.
+  FILE* stream_;
+  std::set<MemorySliceId> streamed_buckets_;
+  bool stream_failed_;
 };
 
 // Stores the respective memory slices of a particular time slice in a map.
@@ -17,6 +17,7 @@
 #include <map>
 #include <vector>
 
+#include "base/files/file_util.h"
 #include "syzygy/core/random_number_generator.h"
 #include "syzygy/core/unittest_util.h"
 #include "syzygy/pdb/omap.h"
@@ -474,4 +475,144 @@ TEST_F(HeatMapSimulationTest, RandomInput) {
   }
 }
 
+TEST_F(HeatMapSimulationTest, StreamedHeatMap) {
+  typedef std::map<std::pair<int64_t, uint32_t>, uint32_t> QuantityMap;
+
+  // Simulate blocks_ in memory first.
+  simulation_->set_memory_slice_bytes(4);
+  simulation_->OnProcessStarted(time, 0);
+  for (uint32_t i = 0; i < arraysize(blocks_); i++) {
+    simulation_->OnFunctionEntry(Time::FromTimeT(blocks_[i].time),
+                                 blocks_[i].block);
+  }
+  QuantityMap expected_quantities;
+  HeatMapSimulation::TimeMemoryMap::const_iterator time_iter =
+      simulation_->time_memory_map().begin();
+  for (; time_iter != simulation_->time_memory_map().end(); ++time_iter) {
+    TimeSlice::MemorySliceMap::const_iterator slice_iter =
+        time_iter->second.slices().begin();
+    for (; slice_iter != time_iter->second.slices().end(); ++slice_iter) {
+      expected_quantities[std::make_pair(time_iter->first,
+                                         slice_iter->first)] =
+          slice_iter->second.total;
+    }
+  }
+
+  // Then stream them.
+  base::FilePath temp_dir;
+  ASSERT_NO_FATAL_FAILURE(CreateTemporaryDir(&temp_dir));
+  base::FilePath path = temp_dir.Append(L"heat_map.bin");
+  base::ScopedFILE stream(base::OpenFile(path, "wb"));
+  ASSERT_TRUE(stream.get() != NULL);
+
+  simulation_.reset(new HeatMapSimulation());
+  simulation_->set_memory_slice_bytes(4);
+  simulation_->set_flush_lag_slices(0);
+  ASSERT_TRUE(simulation_->StartStreaming(stream.get()));
+  simulation_->OnProcessStarted(time, 0);
+  for (uint32_t i = 0; i < arraysize(blocks_); i++) {
+    simulation_->OnFunctionEntry(Time::FromTimeT(blocks_[i].time),
+                                 blocks_[i].block);
+  }
+
+  // Only the latest time slice is still in memory.
+  EXPECT_EQ(1U, simulation_->time_memory_map().size());
+  ASSERT_TRUE(simulation_->FinishStreaming());
+  EXPECT_TRUE(simulation_->time_memory_map().empty());
+  stream.reset();
+
+  // Read the stream back.
+  std::string contents;
+  ASSERT_TRUE(base::ReadFileToString(path, &contents));
+  ASSERT_LE(sizeof(HeatMapSimulation::StreamHeader), contents.size());
+  const HeatMapSimulation::StreamHeader* header =
+      reinterpret_cast<const HeatMapSimulation::StreamHeader*>(
+          contents.data());
+  EXPECT_EQ(HeatMapSimulation::StreamHeader::kMagic, header->magic);
+  EXPECT_EQ(HeatMapSimulation::StreamHeader::kVersion, header->version);
+  EXPECT_EQ(4U, header->memory_slice_bytes);
+  EXPECT_EQ(0U, header->function_buckets);
+
+  QuantityMap quantities;
+  size_t record_count = 0;
+  const uint8_t* cursor = reinterpret_cast<const uint8_t*>(contents.data()) +
+      sizeof(HeatMapSimulation::StreamHeader);
+  const uint8_t* end =
+      reinterpret_cast<const uint8_t*>(contents.data()) + contents.size();
+  while (cursor < end) {
+    uint32_t record_type = 0;
+    int64_t time_slice = 0;
+    uint32_t slice_count = 0;
+    ASSERT_LE(sizeof(record_type) + sizeof(time_slice) + sizeof(slice_count),
+              static_cast<size_t>(end - cursor));
+    ::memcpy(&record_type, cursor, sizeof(record_type));
+    cursor += sizeof(record_type);
+    ASSERT_EQ(HeatMapSimulation::kTimeSliceRecord, record_type);
+    ::memcpy(&time_slice, cursor, sizeof(time_slice));
+    cursor += sizeof(time_slice);
+    ::memcpy(&slice_count, cursor, sizeof(slice_count));
+    cursor += sizeof(slice_count);
+
+    ASSERT_LE(slice_count * 2 * sizeof(uint32_t),
+              static_cast<size_t>(end - cursor));
+    for (uint32_t i = 0; i < slice_count; ++i) {
+      uint32_t slice = 0;
+      uint32_t quantity = 0;
+      ::memcpy(&slice, cursor, sizeof(slice));
+      cursor += sizeof(slice);
+      ::memcpy(&quantity, cursor, sizeof(quantity));
+      cursor += sizeof(quantity);
+      quantities[std::make_pair(time_slice, slice)] += quantity;
+    }
+    ++record_count;
+  }
+
+  EXPECT_EQ(2U, record_count);
+  EXPECT_EQ(expected_quantities, quantities);
+}
+
+TEST_F(HeatMapSimulationTest, FunctionBuckets) {
+  simulation_->set_function_buckets(true);
+  simulation_->OnProcessStarted(time, 0);
+  for (uint32_t i = 0; i < arraysize(blocks_); i++) {
+    simulation_->OnFunctionEntry(Time::FromTimeT(blocks_[i].time),
+                                 blocks_[i].block);
+  }
+
+  // Unnamed blocks have no bucket.
+  BlockGraph::Block* unnamed_block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 10, "");
+  simulation_->OnFunctionEntry(Time::FromTimeT(20), unnamed_block);
+
+  // Each block has its own bucket, holding its whole size.
+  ASSERT_EQ(2U, simulation_->time_memory_map().size());
+  const TimeSlice& time_slice =
+      simulation_->time_memory_map().begin()->second;
+  EXPECT_EQ(8U, time_slice.slices().size());
+  TimeSlice::MemorySliceMap::const_iterator slice_iter =
+      time_slice.slices().find(blocks_[2].block->id());
+  ASSERT_TRUE(slice_iter != time_slice.slices().end());
+  EXPECT_EQ(4U, slice_iter->second.total);
+  EXPECT_EQ(blocks_[8].block->id(), simulation_->max_memory_slice_bytes());
+}
+
+TEST_F(HeatMapSimulationTest, SamplePeriod) {
+  simulation_->set_sample_period(2);
+  simulation_->set_memory_slice_bytes(0x1000);
+  simulation_->OnProcessStarted(time, 0);
+  for (uint32_t i = 0; i < arraysize(blocks_); i++) {
+    simulation_->OnFunctionEntry(Time::FromTimeT(blocks_[i].time),
+                                 blocks_[i].block);
+  }
+
+  // Blocks 0, 2, 4, 6 and 8 are simulated, with twice their size.
+  HeatMapSimulation::TimeMemoryMap::const_iterator time_iter =
+      simulation_->time_memory_map().find(10000000);
+  ASSERT_TRUE(time_iter != simulation_->time_memory_map().end());
+  EXPECT_EQ(2U * (3 + 4 + 3 + 4), time_iter->second.total());
+  time_iter = simulation_->time_memory_map().find(30000000);
+  ASSERT_TRUE(time_iter != simulation_->time_memory_map().end());
+  EXPECT_EQ(2U * 5, time_iter->second.total());
+}
+
 }  // namespace simulate
@@ -0,0 +1,191 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/simulate/page_fault_sweep_simulation.h"
+
+#include <algorithm>
+
+#include "base/sys_info.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/simple_thread.h"
+#include "syzygy/core/json_file_writer.h"
+#include "syzygy/simulate/page_fault_simulation.h"
+
+namespace simulate {
+
+// Simulates the configurations, one per call to Run.
+class PageFaultSweepSimulation::SimulateDelegate
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit SimulateDelegate(PageFaultSweepSimulation* simulation)
+      : simulation_(simulation), next_configuration_(0) {
+    DCHECK(simulation != NULL);
+  }
+
+  void Run() override {
+    Configuration* configuration = NULL;
+    {
+      base::AutoLock auto_lock(lock_);
+      DCHECK_LT(next_configuration_, simulation_->configurations_.size());
+      configuration = &simulation_->configurations_[next_configuration_++];
+    }
+    simulation_->SimulateConfiguration(configuration);
+  }
+
+ private:
+  PageFaultSweepSimulation* simulation_;
+  base::Lock lock_;
+  size_t next_configuration_;  // Under lock_.
+
+  DISALLOW_COPY_AND_ASSIGN(SimulateDelegate);
+};
+
+PageFaultSweepSimulation::PageFaultSweepSimulation()
+    : default_page_size_(0),
+      simulated_range_count_(0),
+      worker_count_(base::SysInfo::NumberOfProcessors()) {
+  DCHECK_LT(0U, worker_count_);
+}
+
+void PageFaultSweepSimulation::AddConfiguration(size_t page_size,
+                                                size_t pages_per_code_fault) {
+  DCHECK_LT(0U, pages_per_code_fault);
+  // Configurations are simulated in step, so they can't be added midway.
+  DCHECK_EQ(0U, simulated_range_count_);
+  configurations_.push_back(Configuration(page_size, pages_per_code_fault));
+}
+
+void PageFaultSweepSimulation::OnProcessStarted(base::Time /*time*/,
+                                                size_t default_page_size) {
+  // Set the default page size if it wasn't set by a trace file yet.
+  if (default_page_size_ == 0 && default_page_size != 0) {
+    default_page_size_ = default_page_size;
+    LOG(INFO) << "Default page size set to " << default_page_size_;
+  }
+}
+
+void PageFaultSweepSimulation::OnFunctionEntry(base::Time /*time*/,
+                                               const Block* block) {
+  DCHECK(block != NULL);
+
+  // The pages of a block are all loaded once it was entered, so further
+  // entries can't fault.
+  if (!blocks_.insert(block).second)
+    return;
+
+  BlockRange range = { block->addr().value(),
+                       static_cast<uint32_t>(block->size()) };
+  block_ranges_.push_back(range);
+}
+
+void PageFaultSweepSimulation::Simulate() {
+  if (simulated_range_count_ == block_ranges_.size())
+    return;
+
+  SimulateDelegate delegate(this);
+  if (worker_count_ == 1 || configurations_.size() <= 1) {
+    for (size_t i = 0; i < configurations_.size(); ++i)
+      delegate.Run();
+  } else {
+    base::DelegateSimpleThreadPool pool(
+        "PageFaultSweepSimulation",
+        static_cast<int>(std::min(worker_count_, configurations_.size())));
+    pool.Start();
+    pool.AddWork(&delegate, static_cast<int>(configurations_.size()));
+    pool.JoinAll();
+  }
+
+  simulated_range_count_ = block_ranges_.size();
+}
+
+bool PageFaultSweepSimulation::SerializeToJSON(FILE* output,
+                                               bool pretty_print) {
+  DCHECK(output != NULL);
+  Simulate();
+
+  core::JSONFileWriter json_file(output, pretty_print);
+  if (!json_file.OpenList())
+    return false;
+
+  for (size_t i = 0; i < configurations_.size(); ++i) {
+    const Configuration& configuration = configurations_[i];
+    if (!json_file.OpenDict() ||
+        !json_file.OutputKey("page_size") ||
+        !json_file.OutputInteger(configuration.page_size) ||
+        !json_file.OutputKey("pages_per_code_fault") ||
+        !json_file.OutputInteger(configuration.pages_per_code_fault) ||
+        !json_file.OutputKey("fault_count") ||
+        !json_file.OutputInteger(configuration.fault_count) ||
+        !json_file.OutputKey("loaded_pages") ||
+        !json_file.OpenList()) {
+      return false;
+    }
+
+    for (size_t j = 0; j < configuration.pages.size(); ++j) {
+      if (configuration.pages[j] && !json_file.OutputInteger(j))
+        return false;
+    }
+
+    if (!json_file.CloseList() ||
+        !json_file.CloseDict()) {
+      return false;
+    }
+  }
+
+  if (!json_file.CloseList())
+    return false;
+
+  DCHECK(json_file.Finished());
+  return true;
+}
+
+void PageFaultSweepSimulation::SimulateConfiguration(
+    Configuration* configuration) const {
+  DCHECK(configuration != NULL);
+
+  // The page size is settled the first time the configuration is simulated.
+  if (configuration->page_size == 0) {
+    configuration->page_size = default_page_size_ != 0 ?
+        default_page_size_ : PageFaultSimulation::kDefaultPageSize;
+  }
+
+  // Loop through all the pages of each block, and if one isn't already in
+  // memory then simulate a code fault and load all the faulting pages in
+  // memory, as PageFaultSimulation does.
+  const size_t page_size = configuration->page_size;
+  const size_t pages_per_code_fault = configuration->pages_per_code_fault;
+  std::vector<bool>& pages = configuration->pages;
+  for (size_t i = simulated_range_count_; i < block_ranges_.size(); ++i) {
+    const BlockRange& range = block_ranges_[i];
+    const size_t start_index = range.start / page_size;
+    const size_t end_index =
+        (range.start + range.size + page_size - 1) / page_size;
+    for (size_t j = start_index; j < end_index; ++j) {
+      if (j < pages.size() && pages[j])
+        continue;
+
+      ++configuration->fault_count;
+      if (pages.size() < j + pages_per_code_fault)
+        pages.resize(j + pages_per_code_fault, false);
+      for (size_t k = j; k < j + pages_per_code_fault; ++k) {
+        if (!pages[k]) {
+          pages[k] = true;
+          ++configuration->loaded_page_count;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace simulate
@@ -0,0 +1,145 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file provides the PageFaultSweepSimulation class.
+
+#ifndef SYZYGY_SIMULATE_PAGE_FAULT_SWEEP_SIMULATION_H_
+#define SYZYGY_SIMULATE_PAGE_FAULT_SWEEP_SIMULATION_H_
+
+#include <set>
+#include <vector>
+
+#include "syzygy/simulate/simulation_event_handler.h"
+
+namespace simulate {
+
+// An implementation of SimulationEventHandler. PageFaultSweepSimulation
+// counts the page faults that PageFaultSimulation would count, for many
+// (page size, pages per code fault) configurations at once, in a single pass
+// over the trace files. Sample usage:
+//
+// PageFaultSweepSimulation simulation;
+//
+// simulation.AddConfiguration(0x1000, 8);
+// simulation.AddConfiguration(0x2000, 4);
+// simulation.OnProcessStarted(time, 0);
+// simulation.OnFunctionEntry(time, block1);
+// simulation.OnFunctionEntry(time, block2);
+// simulation.SerializeToJSON(file, pretty_print);
+//
+// Pages are never evicted, so only the first entry of each block can fault.
+// The simulation records those entries while the traces are parsed, then
+// replays them on each configuration. Each configuration has its own bitset of
+// loaded pages, and the configurations are simulated in parallel.
+//
+// A configuration with a page size of 0 uses the page size of the trace
+// files or, if that's not possible, PageFaultSimulation::kDefaultPageSize.
+class PageFaultSweepSimulation : public SimulationEventHandler {
+ public:
+  typedef block_graph::BlockGraph::Block Block;
+
+  // The state of the simulation of one configuration.
+  struct Configuration {
+    Configuration(size_t page_size, size_t pages_per_code_fault)
+        : page_size(page_size),
+          pages_per_code_fault(pages_per_code_fault),
+          fault_count(0),
+          loaded_page_count(0) {
+    }
+
+    size_t page_size;
+    size_t pages_per_code_fault;
+    // The pages loaded in the simulation, by page index.
+    std::vector<bool> pages;
+    size_t fault_count;
+    size_t loaded_page_count;
+  };
+  typedef std::vector<Configuration> Configurations;
+
+  // Constructs a new PageFaultSweepSimulation instance, with no
+  // configurations.
+  PageFaultSweepSimulation();
+
+  // Adds a configuration to simulate.
+  // @param page_size the size of each page, in bytes, or 0 to use the page
+  //     size of the trace files.
+  // @param pages_per_code_fault the number of pages loaded by each code
+  //     fault. Must be positive.
+  void AddConfiguration(size_t page_size, size_t pages_per_code_fault);
+
+  // Simulates the configurations over the function entries seen so far.
+  // This is done by SerializeToJSON, and is only needed to examine the
+  // configurations before that.
+  void Simulate();
+
+  // @name Accessors and mutators.
+  // @{
+  const Configurations& configurations() const { return configurations_; }
+  size_t worker_count() const { return worker_count_; }
+  void set_worker_count(size_t worker_count) {
+    DCHECK_LT(0U, worker_count);
+    worker_count_ = worker_count;
+  }
+  // @}
+
+  // @name SimulationEventHandler implementation
+  // @{
+  // Sets the default page size, if it's not set already.
+  void OnProcessStarted(base::Time time, size_t default_page_size) override;
+
+  // Records the first entry of each code block.
+  void OnFunctionEntry(base::Time time, const Block* block) override;
+
+  // The serialization consists of a list holding a dictionary for each
+  // configuration, in the format of PageFaultSimulation.
+  bool SerializeToJSON(FILE* output, bool pretty_print) override;
+  // @}
+
+ protected:
+  // The address range of a block, at its first entry.
+  struct BlockRange {
+    uint32_t start;
+    uint32_t size;
+  };
+  typedef std::vector<BlockRange> BlockRanges;
+
+  // Simulates one configuration over block_ranges_.
+  // @param configuration the configuration to simulate.
+  void SimulateConfiguration(Configuration* configuration) const;
+
+  // The simulated configurations.
+  Configurations configurations_;
+
+  // The blocks seen so far, and their address ranges in first-entry order.
+  std::set<const Block*> blocks_;
+  BlockRanges block_ranges_;
+
+  // The page size of the trace files, or 0 if unknown yet.
+  size_t default_page_size_;
+
+  // The number of entries the configurations were simulated over.
+  size_t simulated_range_count_;
+
+  // The number of worker threads simulating the configurations.
+  size_t worker_count_;
+
+ private:
+  class SimulateDelegate;
+
+  DISALLOW_COPY_AND_ASSIGN(PageFaultSweepSimulation);
+};
+
+}  // namespace simulate
+
+#endif  // SYZYGY_SIMULATE_PAGE_FAULT_SWEEP_SIMULATION_H_
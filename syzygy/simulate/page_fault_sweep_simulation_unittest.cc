@@ -0,0 +1,195 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/simulate/page_fault_sweep_simulation.h"
+
+#include "base/values.h"
+#include "base/files/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/json/json_reader.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/random_number_generator.h"
+#include "syzygy/simulate/page_fault_simulation.h"
+
+namespace simulate {
+
+namespace {
+
+using base::DictionaryValue;
+using base::ListValue;
+using base::Value;
+using block_graph::BlockGraph;
+
+class PageFaultSweepSimulationTest : public testing::Test {
+ public:
+  typedef PageFaultSweepSimulation::Configurations Configurations;
+
+  PageFaultSweepSimulationTest() : random_(123) {
+  }
+
+  // Adds random blocks to block_graph_.
+  // @param count the number of blocks to add.
+  void AddRandomBlocks(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      BlockGraph::Block* block = block_graph_.AddBlock(
+          BlockGraph::CODE_BLOCK, 1 + random_(0x800), "block");
+      block->set_addr(core::RelativeAddress(random_(0x40000)));
+      blocks_.push_back(block);
+    }
+  }
+
+  // Enters the blocks of blocks_ in a random order, with repetitions.
+  // @param simulation the simulation receiving the entries.
+  // @param reference the reference simulations receiving the entries.
+  void EnterRandomBlocks(PageFaultSweepSimulation* simulation,
+                         std::vector<PageFaultSimulation*>* reference) {
+    for (size_t i = 0; i < 2 * blocks_.size(); ++i) {
+      const BlockGraph::Block* block = blocks_[random_(blocks_.size())];
+      simulation->OnFunctionEntry(time_, block);
+      for (size_t j = 0; j < reference->size(); ++j)
+        (*reference)[j]->OnFunctionEntry(time_, block);
+    }
+  }
+
+ protected:
+  std::vector<const BlockGraph::Block*> blocks_;
+  core::RandomNumberGenerator random_;
+  const base::Time time_;
+  BlockGraph block_graph_;
+};
+
+}  // namespace
+
+TEST_F(PageFaultSweepSimulationTest, MatchesPageFaultSimulation) {
+  static const size_t kPageSizes[] = { 0x1000, 0x2000, 0x10000 };
+  static const size_t kPagesPerCodeFault[] = { 1, 4, 8 };
+
+  AddRandomBlocks(200);
+
+  PageFaultSweepSimulation simulation;
+  std::vector<PageFaultSimulation*> reference;
+  for (size_t i = 0; i < arraysize(kPageSizes); ++i) {
+    for (size_t j = 0; j < arraysize(kPagesPerCodeFault); ++j) {
+      simulation.AddConfiguration(kPageSizes[i], kPagesPerCodeFault[j]);
+      reference.push_back(new PageFaultSimulation());
+      reference.back()->set_page_size(kPageSizes[i]);
+      reference.back()->set_pages_per_code_fault(kPagesPerCodeFault[j]);
+    }
+  }
+
+  simulation.OnProcessStarted(time_, 0x1000);
+  for (size_t i = 0; i < reference.size(); ++i)
+    reference[i]->OnProcessStarted(time_, 0x1000);
+
+  // Simulate midway, to check that the simulation resumes where it stopped.
+  EnterRandomBlocks(&simulation, &reference);
+  simulation.Simulate();
+  EnterRandomBlocks(&simulation, &reference);
+  simulation.Simulate();
+
+  const Configurations& configurations = simulation.configurations();
+  ASSERT_EQ(reference.size(), configurations.size());
+  for (size_t i = 0; i < reference.size(); ++i) {
+    EXPECT_EQ(reference[i]->page_size(), configurations[i].page_size);
+    EXPECT_EQ(reference[i]->fault_count(), configurations[i].fault_count);
+    EXPECT_EQ(reference[i]->pages().size(),
+              configurations[i].loaded_page_count);
+    delete reference[i];
+  }
+}
+
+TEST_F(PageFaultSweepSimulationTest, WorkerCountDoesNotChangeResults) {
+  AddRandomBlocks(100);
+
+  PageFaultSweepSimulation simulation1;
+  PageFaultSweepSimulation simulation4;
+  simulation1.set_worker_count(1);
+  simulation4.set_worker_count(4);
+  for (size_t i = 1; i <= 8; ++i) {
+    simulation1.AddConfiguration(0x1000 * i, 9 - i);
+    simulation4.AddConfiguration(0x1000 * i, 9 - i);
+  }
+
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    simulation1.OnFunctionEntry(time_, blocks_[i]);
+    simulation4.OnFunctionEntry(time_, blocks_[i]);
+  }
+  simulation1.Simulate();
+  simulation4.Simulate();
+
+  for (size_t i = 0; i < simulation1.configurations().size(); ++i) {
+    EXPECT_EQ(simulation1.configurations()[i].fault_count,
+              simulation4.configurations()[i].fault_count);
+    EXPECT_EQ(simulation1.configurations()[i].pages,
+              simulation4.configurations()[i].pages);
+  }
+}
+
+TEST_F(PageFaultSweepSimulationTest, DefaultPageSize) {
+  PageFaultSweepSimulation simulation;
+  simulation.AddConfiguration(0, 1);
+  simulation.OnProcessStarted(time_, 0x2000);
+  simulation.OnProcessStarted(time_, 0x1000);
+
+  AddRandomBlocks(1);
+  simulation.OnFunctionEntry(time_, blocks_[0]);
+  simulation.Simulate();
+
+  EXPECT_EQ(0x2000U, simulation.configurations()[0].page_size);
+}
+
+TEST_F(PageFaultSweepSimulationTest, JSONSucceeds) {
+  PageFaultSweepSimulation simulation;
+  simulation.AddConfiguration(1, 4);
+  simulation.AddConfiguration(2, 1);
+  simulation.OnProcessStarted(time_, 1);
+
+  BlockGraph::Block* block =
+      block_graph_.AddBlock(BlockGraph::CODE_BLOCK, 3, "block");
+  block->set_addr(core::RelativeAddress(2));
+  simulation.OnFunctionEntry(time_, block);
+
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  base::FilePath path = temp_dir.path().Append(L"sweep.json");
+  base::ScopedFILE file(base::OpenFile(path, "w"));
+  ASSERT_TRUE(file.get() != NULL);
+  ASSERT_TRUE(simulation.SerializeToJSON(file.get(), false));
+  file.reset();
+
+  std::string file_string;
+  ASSERT_TRUE(base::ReadFileToString(path, &file_string));
+  std::unique_ptr<Value> value(base::JSONReader::Read(file_string).release());
+  ASSERT_TRUE(value.get() != NULL);
+  const ListValue* list = NULL;
+  ASSERT_TRUE(value->GetAsList(&list));
+  ASSERT_EQ(2U, list->GetSize());
+
+  // Bytes [2, 5) fault once with 1-byte pages loaded 4 at a time, and twice
+  // with 2-byte pages loaded one at a time.
+  int expected_fault_counts[] = { 1, 2 };
+  size_t expected_page_counts[] = { 4, 2 };
+  for (size_t i = 0; i < list->GetSize(); ++i) {
+    const DictionaryValue* dict = NULL;
+    ASSERT_TRUE(list->GetDictionary(i, &dict));
+    int fault_count = 0;
+    ASSERT_TRUE(dict->GetInteger("fault_count", &fault_count));
+    EXPECT_EQ(expected_fault_counts[i], fault_count);
+    const ListValue* loaded_pages = NULL;
+    ASSERT_TRUE(dict->GetList("loaded_pages", &loaded_pages));
+    EXPECT_EQ(expected_page_counts[i], loaded_pages->GetSize());
+  }
+}
+
+}  // namespace simulate
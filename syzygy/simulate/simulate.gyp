@@ -25,6 +25,8 @@
         'heat_map_simulation.h',
         'page_fault_simulation.cc',
         'page_fault_simulation.h',
+        'page_fault_sweep_simulation.cc',
+        'page_fault_sweep_simulation.h',
         'simulation_event_handler.h',
         'simulator.cc',
         'simulator.h',
@@ -54,6 +56,7 @@
       'sources': [
         'heat_map_simulation_unittest.cc',
         'page_fault_simulation_unittest.cc',
+        'page_fault_sweep_simulation_unittest.cc',
         'simulator_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
       ],
@@ -22,14 +22,17 @@
 #include "base/at_exit.h"
 #include "base/command_line.h"
 #include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
 #include "syzygy/simulate/heat_map_simulation.h"
 #include "syzygy/simulate/page_fault_simulation.h"
+#include "syzygy/simulate/page_fault_sweep_simulation.h"
 #include "syzygy/simulate/simulator.h"
 
 namespace {
 
 using simulate::HeatMapSimulation;
 using simulate::PageFaultSimulation;
+using simulate::PageFaultSweepSimulation;
 using simulate::SimulationEventHandler;
 using simulate::Simulator;
 
@@ -37,8 +40,8 @@ const char kUsage[] =
     "Usage: simulate [options] [RPC log files ...]\n"
     "  Required Options:\n"
     "    --instrumented-dll=<path> the path to the instrumented DLL.\n"
-    "    --simulate-method=pagefault|heatmap what method used to simulate\n"
-    "        the trace files.\n"
+    "    --simulate-method=pagefault|pagefault-sweep|heatmap what method\n"
+    "        used to simulate the trace files.\n"
     "  Optional Options:\n"
     "    --pretty-print enables pretty printing of the JSON output file.\n"
     "    --input-dll=<path> the input DLL from where the trace files belong.\n"
@@ -47,19 +50,60 @@ const char kUsage[] =
     "      --pages-per-code-fault=INT The number of pages loaded by each\n"
     "          page-fault (default 8)\n"
     "      --page-size=INT the size of each page, in bytes (default 4KB).\n"
+    "    For page fault sweep method:\n"
+    "      --page-sizes=<comma separated INTs> the page sizes to simulate,\n"
+    "          in bytes (default the page size of the trace files).\n"
+    "      --pages-per-code-fault=<comma separated INTs> the numbers of\n"
+    "          pages loaded by each page-fault to simulate (default 8).\n"
+    "          Every page size is simulated with every number of pages.\n"
     "    For heat map method:\n"
     "      --time-slice-usecs=INT the size of each time slice in the heatmap,\n"
     "          in microseconds (default 1).\n"
     "      --memory-slice-bytes=INT the size of each memory slice,\n"
     "          in bytes (default 32KB).\n"
     "      --output-individual-functions Output information about each\n"
-    "          function in each time/memory block\n";
+    "          function in each time/memory block\n"
+    "      --stream streams the heat map to the output file in binary form\n"
+    "          while the trace files are parsed, instead of writing it as\n"
+    "          JSON at the end. This requires --output-file.\n"
+    "      --flush-lag-slices=INT the number of time slices kept in memory\n"
+    "          behind the latest one when streaming (default 16).\n"
+    "      --sample-period=INT simulates one of every INT function entries\n"
+    "          (default 1).\n"
+    "      --function-buckets uses one bucket per symbolized function\n"
+    "          instead of memory slices.\n";
 
 int Usage(const char* message) {
   std::cerr << message << std::endl << kUsage;
   return 1;
 }
 
+// Parses a comma separated list of positive integers.
+// @param values_str the list to parse.
+// @param default_value the value of an empty list.
+// @param values receives the parsed values.
+// @returns true on success, false on failure.
+bool ParseSizeList(const std::string& values_str,
+                   size_t default_value,
+                   std::vector<size_t>* values) {
+  DCHECK(values != NULL);
+
+  std::vector<std::string> value_strs = base::SplitString(
+      values_str, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  if (value_strs.empty()) {
+    values->push_back(default_value);
+    return true;
+  }
+
+  for (size_t i = 0; i < value_strs.size(); ++i) {
+    unsigned int value = 0;
+    if (!base::StringToUint(value_strs[i], &value) || value == 0)
+      return false;
+    values->push_back(value);
+  }
+  return true;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -96,6 +140,8 @@ int main(int argc, char** argv) {
     return Usage("You must specify at least one trace file.");
 
   std::unique_ptr<SimulationEventHandler> simulation;
+  HeatMapSimulation* heat_map_simulation = NULL;
+  bool stream_heat_map = false;
 
   if (simulate_method == "pagefault") {
     PageFaultSimulation* page_fault_simulation = new PageFaultSimulation();
@@ -121,8 +167,31 @@ int main(int argc, char** argv) {
       else
         page_fault_simulation->set_pages_per_code_fault(pages_per_code_fault);
     }
+  } else if (simulate_method == "pagefault-sweep") {
+    PageFaultSweepSimulation* page_fault_sweep_simulation =
+        new PageFaultSweepSimulation();
+    simulation.reset(page_fault_sweep_simulation);
+
+    std::vector<size_t> page_sizes;
+    std::vector<size_t> pages_per_code_faults;
+    if (!ParseSizeList(cmd_line->GetSwitchValueASCII("page-sizes"), 0,
+                       &page_sizes)) {
+      return Usage("Invalid page-sizes value.");
+    }
+    if (!ParseSizeList(cmd_line->GetSwitchValueASCII("pages-per-code-fault"),
+                       PageFaultSimulation::kDefaultPagesPerCodeFault,
+                       &pages_per_code_faults)) {
+      return Usage("Invalid pages-per-code-fault value.");
+    }
+
+    for (size_t i = 0; i < page_sizes.size(); ++i) {
+      for (size_t j = 0; j < pages_per_code_faults.size(); ++j) {
+        page_fault_sweep_simulation->AddConfiguration(
+            page_sizes[i], pages_per_code_faults[j]);
+      }
+    }
   } else if (simulate_method == "heatmap") {
-    HeatMapSimulation* heat_map_simulation = new HeatMapSimulation();
+    heat_map_simulation = new HeatMapSimulation();
     DCHECK(heat_map_simulation != NULL);
     simulation.reset(heat_map_simulation);
 
@@ -149,6 +218,35 @@ int main(int argc, char** argv) {
 
     heat_map_simulation->set_output_individual_functions(
         cmd_line->HasSwitch("output-individual-functions"));
+    heat_map_simulation->set_function_buckets(
+        cmd_line->HasSwitch("function-buckets"));
+
+    int flush_lag_slices = 0;
+    int sample_period = 0;
+    StringType flush_lag_slices_str =
+        cmd_line->GetSwitchValueNative("flush-lag-slices");
+    StringType sample_period_str =
+        cmd_line->GetSwitchValueNative("sample-period");
+
+    if (!flush_lag_slices_str.empty()) {
+      if (!base::StringToInt(flush_lag_slices_str, &flush_lag_slices) ||
+          flush_lag_slices < 0) {
+        return Usage("Invalid flush-lag-slices value.");
+      }
+      heat_map_simulation->set_flush_lag_slices(flush_lag_slices);
+    }
+
+    if (!sample_period_str.empty()) {
+      if (!base::StringToInt(sample_period_str, &sample_period) ||
+          sample_period <= 0) {
+        return Usage("Invalid sample-period value.");
+      }
+      heat_map_simulation->set_sample_period(sample_period);
+    }
+
+    stream_heat_map = cmd_line->HasSwitch("stream");
+    if (stream_heat_map && output_file_path.empty())
+      return Usage("Streaming requires output-file.");
   } else {
     return Usage("Invalid simulate-method value.");
   }
@@ -159,6 +257,26 @@ int main(int argc, char** argv) {
                       trace_paths,
                       simulation.get());
 
+  // A streamed heat map is written while the trace files are parsed.
+  if (stream_heat_map) {
+    base::ScopedFILE stream_file(base::OpenFile(output_file_path, "wb"));
+    if (stream_file.get() == NULL) {
+      LOG(ERROR) << "Failed to open " << output_file_path.value()
+          << " for writing.";
+      return 1;
+    }
+
+    LOG(INFO) << "Parsing trace files and streaming the heat map.";
+    if (!heat_map_simulation->StartStreaming(stream_file.get()) ||
+        !simulator.ParseTraceFiles() ||
+        !heat_map_simulation->FinishStreaming()) {
+      LOG(ERROR) << "Could not stream the heat map.";
+      return 1;
+    }
+
+    return 0;
+  }
+
   LOG(INFO) << "Parsing trace files.";
   if (!simulator.ParseTraceFiles()) {
     LOG(ERROR) << "Could not parse trace files.";
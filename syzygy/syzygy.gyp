@@ -31,6 +31,7 @@
         }, {
           'dependencies': [
             'agent/asan/asan.gyp:*',
+            'agent/asan/benchmark/benchmark.gyp:*',
             'agent/basic_block_entry/basic_block_entry.gyp:*',
             'agent/call_trace/call_trace.gyp:*',
             'agent/common/common.gyp:*',
@@ -140,7 +140,8 @@ BOOL CALLBACK ReadProcessMemoryProc64(HANDLE process,
 AgentLogger::AgentLogger()
     : trace::common::Service(L"Logger"),
       destination_(NULL),
-      symbolize_stack_traces_(true) {
+      symbolize_stack_traces_(true),
+      symbolizer_thread_("Symbolizer") {
 }
 
 AgentLogger::~AgentLogger() {
@@ -153,6 +154,11 @@ AgentLogger::~AgentLogger() {
 bool AgentLogger::StartImpl() {
   LOG(INFO) << "Starting the logging service.";
 
+  if (!symbolizer_thread_.Start()) {
+    LOG(ERROR) << "Failed to start the symbolizer thread.";
+    return false;
+  }
+
   if (!InitRpc())
     return false;
 
@@ -176,6 +182,10 @@ bool AgentLogger::JoinImpl() {
   if (!FinishRpc())
     return false;
 
+  // Write the messages that are still queued. No new ones can come in now
+  // that the RPC requests are all handled.
+  symbolizer_thread_.Stop();
+
   return true;
 }
 
@@ -206,70 +216,99 @@ bool AgentLogger::AppendTrace(HANDLE process,
 
   base::AutoLock auto_lock(symbol_lock_);
 
-  // Make a unique "handle" for this use of the symbolizer.
-  base::win::ScopedHandle unique_handle(
-      ::OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE,
-                    ::GetCurrentProcessId()));
+  // The frames are symbolized with the help of the PDB of the running
+  // process, so they are cached per module of the running process.
+  std::wstring module_path;
+  WCHAR temp_path[MAX_PATH];
+  if (::GetModuleFileNameEx(process, NULL, temp_path, MAX_PATH) != 0)
+    module_path = temp_path;
 
-  // Initializes the symbols for the process:
-  //     - Defer symbol load until they're needed
-  //     - Use undecorated names
-  //     - Get line numbers
-  ::SymSetOptions(SYMOPT_DEFERRED_LOADS | SYMOPT_UNDNAME | SYMOPT_LOAD_LINES);
-  if (!::common::SymInitialize(unique_handle.Get(), NULL, true))
-    return false;
+  // Look up the frames in the cache, and only bring up the symbolizer if some
+  // of them are missing.
+  std::vector<const std::string*> frames(trace_length, nullptr);
+  std::vector<size_t> missing_frames;
+  for (size_t i = 0; i < trace_length; ++i) {
+    auto it = symbol_cache_.find(SymbolCacheKey(module_path, trace_data[i]));
+    if (it != symbol_cache_.end())
+      frames[i] = &it->second;
+    else
+      missing_frames.push_back(i);
+  }
 
-  // Try to find the PDB of the running process, if it's found its path will be
-  // appended to the current symbol search path. It is necessary because the
-  // default search path doesn't include the directory of the caller by default.
-  // TODO(sebmarchand): Also append the path of the PDBs of the modules loaded
-  //     by the running process.
-  WCHAR temp_path[MAX_PATH];
-  if (::GetModuleFileNameEx(process, NULL, temp_path, MAX_PATH) != 0) {
-    base::FilePath module_path(temp_path);
-    base::FilePath temp_pdb_path;
-    if (pe::FindPdbForModule(module_path, &temp_pdb_path)) {
-      char current_search_path[1024];
-      if (!::SymGetSearchPath(unique_handle.Get(), current_search_path,
-                              arraysize(current_search_path))) {
-        DWORD error = ::GetLastError();
-        LOG(ERROR) << "Unable to get the current symbol search path: "
-                   << ::common::LogWe(error);
-        return false;
-      }
-      std::string new_pdb_search_path = std::string(current_search_path) + ";" +
-                                        temp_pdb_path.DirName().AsUTF8Unsafe();
-      if (!::SymSetSearchPath(unique_handle.Get(),
-                              new_pdb_search_path.c_str())) {
-        LOG(ERROR) << "Unable to set the symbol search path.";
-        return false;
+  if (!missing_frames.empty()) {
+    // Make a unique "handle" for this use of the symbolizer.
+    base::win::ScopedHandle unique_handle(
+        ::OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE,
+                      ::GetCurrentProcessId()));
+
+    // Initializes the symbols for the process:
+    //     - Defer symbol load until they're needed
+    //     - Use undecorated names
+    //     - Get line numbers
+    ::SymSetOptions(SYMOPT_DEFERRED_LOADS | SYMOPT_UNDNAME | SYMOPT_LOAD_LINES);
+    if (!::common::SymInitialize(unique_handle.Get(), NULL, true))
+      return false;
+
+    // Try to find the PDB of the running process, if it's found its path will
+    // be appended to the current symbol search path. It is necessary because
+    // the default search path doesn't include the directory of the caller by
+    // default.
+    // TODO(sebmarchand): Also append the path of the PDBs of the modules
+    //     loaded by the running process.
+    if (!module_path.empty()) {
+      base::FilePath temp_pdb_path;
+      if (pe::FindPdbForModule(base::FilePath(module_path), &temp_pdb_path)) {
+        char current_search_path[1024];
+        if (!::SymGetSearchPath(unique_handle.Get(), current_search_path,
+                                arraysize(current_search_path))) {
+          DWORD error = ::GetLastError();
+          LOG(ERROR) << "Unable to get the current symbol search path: "
+                     << ::common::LogWe(error);
+          return false;
+        }
+        std::string new_pdb_search_path =
+            std::string(current_search_path) + ";" +
+            temp_pdb_path.DirName().AsUTF8Unsafe();
+        if (!::SymSetSearchPath(unique_handle.Get(),
+                                new_pdb_search_path.c_str())) {
+          LOG(ERROR) << "Unable to set the symbol search path.";
+          return false;
+        }
       }
     }
-  }
-
-  // Append each line of the trace to the message string.
-  for (size_t i = 0; i < trace_length; ++i) {
-    uintptr_t frame_ptr = trace_data[i];
-    DWORD64 offset = 0;
-    std::string symbol_name;
-    std::string line_info;
 
-    GetSymbolInfo(unique_handle.Get(), frame_ptr, &symbol_name, &offset);
-    GetLineInfo(unique_handle.Get(), frame_ptr, &line_info);
+    // Symbolize the missing frames and add them to the cache.
+    for (size_t i : missing_frames) {
+      uintptr_t frame_ptr = trace_data[i];
+      DWORD64 offset = 0;
+      std::string symbol_name;
+      std::string line_info;
+
+      GetSymbolInfo(unique_handle.Get(), frame_ptr, &symbol_name, &offset);
+      GetLineInfo(unique_handle.Get(), frame_ptr, &line_info);
+
+      std::string* frame = &symbol_cache_[SymbolCacheKey(module_path,
+                                                         frame_ptr)];
+      base::SStringPrintf(frame,
+                          "0x%012llx in %s%s%s",
+                          frame_ptr + offset,
+                          symbol_name.c_str(),
+                          line_info.empty() ? "" : " ",
+                          line_info.c_str());
+      frames[i] = frame;
+    }
 
-    base::StringAppendF(message,
-                        "    #%d 0x%012llx in %s%s%s\n",
-                        i,
-                        frame_ptr + offset,
-                        symbol_name.c_str(),
-                        line_info.empty() ? "" : " ",
-                        line_info.c_str());
+    if (!::SymCleanup(unique_handle.Get())) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "SymCleanup failed: " << ::common::LogWe(error) << ".";
+      return false;
+    }
   }
 
-  if (!::SymCleanup(unique_handle.Get())) {
-    DWORD error = ::GetLastError();
-    LOG(ERROR) << "SymCleanup failed: " << ::common::LogWe(error) << ".";
-    return false;
+  // Append each line of the trace to the message string.
+  for (size_t i = 0; i < trace_length; ++i) {
+    DCHECK(frames[i] != nullptr);
+    base::StringAppendF(message, "    #%d %s\n", i, frames[i]->c_str());
   }
 
   return true;
@@ -375,6 +414,84 @@ bool AgentLogger::Write(const base::StringPiece& message) {
   return true;
 }
 
+bool AgentLogger::AsyncWrite(const base::StringPiece& message) {
+  std::unique_ptr<PendingMessage> pending_message(new PendingMessage());
+  message.CopyToString(&pending_message->message);
+  return QueueMessage(std::move(pending_message));
+}
+
+bool AgentLogger::AsyncWriteWithTrace(HANDLE process,
+                                      const base::StringPiece& message,
+                                      const uintptr_t* trace_data,
+                                      size_t trace_length) {
+  DCHECK(trace_data != NULL || trace_length == 0);
+
+  // An empty trace leaves the message as is.
+  if (trace_length == 0)
+    return AsyncWrite(message);
+
+  std::unique_ptr<PendingMessage> pending_message(new PendingMessage());
+  HANDLE process_copy = NULL;
+  if (!::DuplicateHandle(::GetCurrentProcess(), process, ::GetCurrentProcess(),
+                         &process_copy, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to duplicate the process handle: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+  pending_message->process.Set(process_copy);
+  message.CopyToString(&pending_message->message);
+  pending_message->trace_data.assign(trace_data, trace_data + trace_length);
+  return QueueMessage(std::move(pending_message));
+}
+
+bool AgentLogger::QueueMessage(
+    std::unique_ptr<PendingMessage> pending_message) {
+  DCHECK(pending_message.get() != nullptr);
+
+  // Write the message right away if there's no thread to do it.
+  if (!symbolizer_thread_.IsRunning())
+    return WritePendingMessage(pending_message.get());
+
+  base::AutoLock auto_lock(pending_lock_);
+
+  // The symbolizer thread writes all of the messages queued by the time it
+  // runs, so it only needs to be woken up for the first one.
+  if (pending_messages_.empty()) {
+    symbolizer_thread_.message_loop()->PostTask(
+        FROM_HERE, base::Bind(&AgentLogger::WritePendingMessages,
+                              base::Unretained(this)));
+  }
+  pending_messages_.push_back(std::move(pending_message));
+
+  return true;
+}
+
+void AgentLogger::WritePendingMessages() {
+  std::vector<std::unique_ptr<PendingMessage>> pending_messages;
+  {
+    base::AutoLock auto_lock(pending_lock_);
+    pending_messages.swap(pending_messages_);
+  }
+
+  for (const auto& pending_message : pending_messages)
+    ignore_result(WritePendingMessage(pending_message.get()));
+}
+
+bool AgentLogger::WritePendingMessage(PendingMessage* pending_message) {
+  DCHECK(pending_message != nullptr);
+
+  if (pending_message->process.IsValid() &&
+      !AppendTrace(pending_message->process.Get(),
+                   pending_message->trace_data.data(),
+                   pending_message->trace_data.size(),
+                   &pending_message->message)) {
+    return false;
+  }
+
+  return Write(pending_message->message);
+}
+
 bool AgentLogger::SaveMinidumpWithProtobufAndMemoryRanges(
     HANDLE process,
     base::ProcessId pid,
@@ -18,12 +18,20 @@
 #ifndef SYZYGY_TRACE_AGENT_LOGGER_AGENT_LOGGER_H_
 #define SYZYGY_TRACE_AGENT_LOGGER_AGENT_LOGGER_H_
 
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "base/callback.h"
 #include "base/files/file_util.h"
 #include "base/message_loop/message_loop.h"
 #include "base/process/process.h"
 #include "base/strings/string_piece.h"
 #include "base/threading/platform_thread.h"
+#include "base/threading/thread.h"
+#include "base/win/scoped_handle.h"
 #include "syzygy/trace/common/service.h"
 #include "syzygy/trace/rpc/logger_rpc.h"
 
@@ -65,6 +73,9 @@ class AgentLogger : public trace::common::Service {
   // Note that the DWORD elements of @p trace_data are really void* values
   // pointing to the frame pointers of a call stack in @p process.
   //
+  // Symbolized frames are cached, so that the frames that show up in many
+  // traces are only looked up once.
+  //
   // Calls to this method are serialized under symbol_lock_.
   bool AppendTrace(HANDLE process,
                    const uintptr_t* trace_data,
@@ -84,6 +95,28 @@ class AgentLogger : public trace::common::Service {
   // are serialized using write_lock_.
   bool Write(const base::StringPiece& message);
 
+  // Queues @p message to be written to the log destination after the
+  // messages queued before it. The message is written by the symbolizer
+  // thread while the logger is running, and synchronously otherwise.
+  // @param message The message to write.
+  // @returns true on success, false otherwise. Failures to write a queued
+  //     message are only logged.
+  bool AsyncWrite(const base::StringPiece& message);
+
+  // Queues @p message to be written to the log destination, followed by the
+  // symbolized trace given by @p trace_data, after the messages queued before
+  // it. See AppendTrace and AsyncWrite.
+  // @param process An open handle to the process the trace comes from. It is
+  //     duplicated, so the caller may close it right away.
+  // @param message The message to write.
+  // @param trace_data The frames of the trace.
+  // @param trace_length The number of frames in @p trace_data.
+  // @returns true on success, false otherwise.
+  bool AsyncWriteWithTrace(HANDLE process,
+                           const base::StringPiece& message,
+                           const uintptr_t* trace_data,
+                           size_t trace_length);
+
   // Generate a minidump for the calling process.
   // @param process An open handle to the running process.
   // @param pid The process id of the process to dump.
@@ -135,6 +168,29 @@ class AgentLogger : public trace::common::Service {
   bool FinishRpc();  // This function is blocking.
   // @}
 
+  // A message waiting to be written by the symbolizer thread.
+  struct PendingMessage {
+    // The process the trace comes from. Invalid if there is no trace.
+    base::win::ScopedHandle process;
+    std::string message;
+    std::vector<uintptr_t> trace_data;
+  };
+
+  // Queues a message for the symbolizer thread, or writes it right away if
+  // the thread isn't running.
+  // @param pending_message The message to write.
+  // @returns true on success, false otherwise.
+  bool QueueMessage(std::unique_ptr<PendingMessage> pending_message);
+
+  // Symbolizes and writes the queued messages, in order. Runs on the
+  // symbolizer thread.
+  void WritePendingMessages();
+
+  // Symbolizes and writes a message.
+  // @param pending_message The message to write.
+  // @returns true on success, false otherwise.
+  bool WritePendingMessage(PendingMessage* pending_message);
+
   // The file to which received log messages should be written. This must
   // remain valid for at least as long as the logger is valid. Writes to
   // the destination are serialized with lock_;
@@ -150,6 +206,20 @@ class AgentLogger : public trace::common::Service {
   // symbolize traces.
   base::Lock symbol_lock_;
 
+  // The symbolized frames, keyed by the path of the module of the process
+  // they were symbolized for and the frame address. Under symbol_lock_.
+  typedef std::pair<std::wstring, uintptr_t> SymbolCacheKey;
+  std::map<SymbolCacheKey, std::string> symbol_cache_;
+
+  // The thread symbolizing and writing the queued messages. Runs from
+  // StartImpl until JoinImpl.
+  base::Thread symbolizer_thread_;
+
+  // The messages waiting to be written by the symbolizer thread, in order.
+  // Under pending_lock_.
+  std::vector<std::unique_ptr<PendingMessage>> pending_messages_;
+  base::Lock pending_lock_;
+
   // Indicates if we should symbolize the stack traces. Defaults to true.
   bool symbolize_stack_traces_;
 
@@ -107,7 +107,7 @@ void InitContext(const ExecutionContext* ext_ctx, CONTEXT* ctx) {
 // The instance to which the RPC callbacks are bound.
 AgentLogger* RpcLoggerInstanceManager::instance_ = NULL;
 
-// RPC entrypoint for AgentLogger::Write().
+// RPC entrypoint for AgentLogger::AsyncWrite().
 boolean LoggerService_Write(
     /* [in] */ handle_t binding,
     /* [string][in] */ const unsigned char *text) {
@@ -119,9 +119,10 @@ boolean LoggerService_Write(
   // Get the logger instance.
   AgentLogger* instance = RpcLoggerInstanceManager::GetInstance();
 
-  // Write the log message.
+  // Queue the log message, so that it is written after the messages that are
+  // still being symbolized.
   std::string message(reinterpret_cast<const char*>(text));
-  if (!instance->Write(message))
+  if (!instance->AsyncWrite(message))
     return false;
 
   // And we're done.
@@ -154,17 +155,14 @@ boolean LoggerService_WriteWithContext(
     return false;
   }
 
-  // Create the log message.
+  // Queue the log message. The trace is symbolized off of the RPC thread, so
+  // the client doesn't wait for it.
   std::string message(reinterpret_cast<const char*>(text));
-  if (!instance->AppendTrace(handle.Get(), trace_data.data(), trace_data.size(),
-                             &message)) {
+  if (!instance->AsyncWriteWithTrace(handle.Get(), message, trace_data.data(),
+                                     trace_data.size())) {
     return false;
   }
 
-  // Write the log message.
-  if (!instance->Write(message))
-    return false;
-
   // And we're done.
   return true;
 }
@@ -188,14 +186,13 @@ boolean LoggerService_WriteWithTrace(
   // Get the logger instance.
   AgentLogger* instance = RpcLoggerInstanceManager::GetInstance();
 
-  // Create the log message.
+  // Queue the log message. The trace is symbolized off of the RPC thread, so
+  // the client doesn't wait for it.
   std::string message(reinterpret_cast<const char*>(text));
-  if (!instance->AppendTrace(handle.Get(), trace_data, trace_length, &message))
-    return false;
-
-  // Write the log message.
-  if (!instance->Write(message))
+  if (!instance->AsyncWriteWithTrace(handle.Get(), message, trace_data,
+                                     trace_length)) {
     return false;
+  }
 
   // And we're done.
   return true;
@@ -273,6 +273,62 @@ TEST_F(LoggerTest, StackTraceHandling) {
   ASSERT_TRUE(function_c != std::string::npos);
 }
 
+TEST_F(LoggerTest, StackTraceIsCached) {
+  HANDLE process = ::GetCurrentProcess();
+  std::vector<uintptr_t> trace_data;
+  ASSERT_NO_FATAL_FAILURE(ExecuteCallbackWithKnownStack(base::Bind(
+      &LoggerTest::DoCaptureRemoteTrace,
+      base::Unretained(this),
+      process,
+      &trace_data)));
+
+  // The second symbolization is served from the cache, and matches the first.
+  std::string text1;
+  ASSERT_TRUE(logger_.AppendTrace(
+      process, trace_data.data(), trace_data.size(), &text1));
+  std::string text2;
+  ASSERT_TRUE(logger_.AppendTrace(
+      process, trace_data.data(), trace_data.size(), &text2));
+  EXPECT_TRUE(TextContainsKnownStack(text1, 0));
+  EXPECT_EQ(text1, text2);
+}
+
+TEST_F(LoggerTest, AsyncWritesAreOrdered) {
+  HANDLE process = ::GetCurrentProcess();
+  std::vector<uintptr_t> trace_data;
+  ASSERT_NO_FATAL_FAILURE(ExecuteCallbackWithKnownStack(base::Bind(
+      &LoggerTest::DoCaptureRemoteTrace,
+      base::Unretained(this),
+      process,
+      &trace_data)));
+
+  // Queue messages with and without traces.
+  ASSERT_TRUE(logger_.AsyncWriteWithTrace(process, kLine1, trace_data.data(),
+                                          trace_data.size()));
+  ASSERT_TRUE(logger_.AsyncWrite(kLine2));
+  ASSERT_TRUE(logger_.AsyncWriteWithTrace(process, kLine3, trace_data.data(),
+                                          trace_data.size()));
+
+  // Stopping the logger writes the queued messages.
+  ASSERT_TRUE(logger_.Stop());
+  ASSERT_NO_FATAL_FAILURE(WaitForLoggerToFinish());
+  log_file_.reset(NULL);
+
+  std::string text;
+  ASSERT_TRUE(base::ReadFileToString(log_file_path_, &text));
+
+  // The messages are written in the order they were queued, each followed by
+  // its trace.
+  size_t line_1 = text.find(kLine1, 0);
+  ASSERT_NE(std::string::npos, line_1);
+  size_t line_2 = text.find(kLine2, line_1);
+  ASSERT_NE(std::string::npos, line_2);
+  size_t line_3 = text.find(kLine3, line_2);
+  ASSERT_NE(std::string::npos, line_3);
+  EXPECT_LT(text.find("FunctionC", line_1), line_2);
+  EXPECT_TRUE(TextContainsKnownStack(text, line_3));
+}
+
 TEST_F(LoggerTest, Write) {
   // Write the lines.
   ASSERT_TRUE(logger_.Write(kLine1));
@@ -31,6 +31,9 @@ RpcSession::RpcSession()
     : rpc_binding_(NULL),
       session_handle_(NULL),
       flags_(0),
+      buffer_exchange_handle_(NULL),
+      buffer_exchange_(NULL),
+      buffer_exchange_event_(NULL),
       is_disabled_(false) {
 }
 
@@ -82,6 +85,85 @@ bool RpcSession::MapSegmentBuffer(TraceFileSegment* segment) {
   return true;
 }
 
+bool RpcSession::OpenBufferExchange() {
+  DCHECK(IsTracing());
+  DCHECK(buffer_exchange_ == NULL);
+
+  unsigned long exchange_handle = 0;
+  unsigned long event_handle = 0;
+  bool succeeded =
+      ::common::rpc::InvokeRpc(CallTraceClient_OpenBufferExchange,
+                               session_handle_, &exchange_handle,
+                               &event_handle).succeeded();
+  if (!succeeded)
+    return false;
+
+  HANDLE mem_handle = reinterpret_cast<HANDLE>(exchange_handle);
+  HANDLE event = reinterpret_cast<HANDLE>(event_handle);
+  trace::common::BufferExchange* exchange =
+      reinterpret_cast<trace::common::BufferExchange*>(::MapViewOfFile(
+          mem_handle, FILE_MAP_WRITE, 0, 0,
+          sizeof(trace::common::BufferExchange)));
+  if (exchange == NULL) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to map view of buffer exchange: "
+               << ::common::LogWe(error) << ".";
+    ignore_result(::CloseHandle(mem_handle));
+    ignore_result(::CloseHandle(event));
+    return false;
+  }
+
+  buffer_exchange_handle_ = mem_handle;
+  buffer_exchange_ = exchange;
+  buffer_exchange_event_ = event;
+
+  return true;
+}
+
+bool RpcSession::TakeFreeBuffer(TraceFileSegment* segment) {
+  DCHECK(segment != NULL);
+
+  if (buffer_exchange_ == NULL)
+    return false;
+
+  bool taken = buffer_exchange_->free_buffers.Pop(&segment->buffer_info);
+  if (!taken || buffer_exchange_->free_buffers.size() ==
+                    trace::common::BufferExchange::kFreeBufferLowWater) {
+    SignalBufferExchange();
+  }
+
+  return taken;
+}
+
+bool RpcSession::QueueFullBuffer(TraceFileSegment* segment) {
+  DCHECK(segment != NULL);
+
+  if (buffer_exchange_ == NULL)
+    return false;
+
+  // If the ring is full the buffer is returned through an RPC, which drains
+  // the ring first.
+  if (!buffer_exchange_->full_buffers.Push(segment->buffer_info))
+    return false;
+
+  if (buffer_exchange_->full_buffers.size() ==
+          trace::common::BufferExchange::kFullBufferHighWater) {
+    SignalBufferExchange();
+  }
+
+  return true;
+}
+
+void RpcSession::SignalBufferExchange() {
+  DCHECK(buffer_exchange_event_ != NULL);
+
+  if (!::SetEvent(buffer_exchange_event_)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to signal buffer exchange: "
+               << ::common::LogWe(error) << ".";
+  }
+}
+
 bool RpcSession::CreateSession(TraceFileSegment* segment) {
   DCHECK(session_handle_ == NULL);
   DCHECK(rpc_binding_ == NULL);
@@ -117,8 +199,10 @@ bool RpcSession::CreateSession(TraceFileSegment* segment) {
   }
 
   if ((flags_ & TRACE_FLAG_BATCH_ENTER) != 0) {
-    // Batch mode is mutually exclusive of all other flags.
-    flags_ = TRACE_FLAG_BATCH_ENTER;
+    // Batch mode is mutually exclusive of all other flags, save for the
+    // compact encoding and the filtering of the batches.
+    flags_ &= TRACE_FLAG_BATCH_ENTER | TRACE_FLAG_COMPACT_RECORDS |
+              TRACE_FLAG_FILTER_REPEATED_ENTRIES;
   }
 
   if (!MapSegmentBuffer(segment)) {
@@ -126,6 +210,10 @@ bool RpcSession::CreateSession(TraceFileSegment* segment) {
     return false;
   }
 
+  // Buffers can still be exchanged through RPCs if this fails.
+  if (!OpenBufferExchange())
+    VLOG(1) << "Exchanging call trace buffers through RPCs.";
+
   return true;
 }
 
@@ -133,6 +221,9 @@ bool RpcSession::AllocateBuffer(TraceFileSegment* segment) {
   DCHECK(IsTracing());
   DCHECK(segment != NULL);
 
+  if (TakeFreeBuffer(segment))
+    return MapSegmentBuffer(segment);
+
   bool succeeded =
       ::common::rpc::InvokeRpc(CallTraceClient_AllocateBuffer, session_handle_,
                                &segment->buffer_info).succeeded();
@@ -171,6 +262,15 @@ bool RpcSession::ExchangeBuffer(TraceFileSegment* segment) {
   DCHECK(IsTracing());
   DCHECK(segment != NULL);
 
+  // In the steady state buffers are exchanged without calling the service.
+  // If it's running behind on restocking, a fresh buffer is allocated the
+  // usual way.
+  if (QueueFullBuffer(segment)) {
+    if (TakeFreeBuffer(segment))
+      return MapSegmentBuffer(segment);
+    return AllocateBuffer(segment);
+  }
+
   bool succeeded =
       ::common::rpc::InvokeRpc(CallTraceClient_ExchangeBuffer, session_handle_,
                                &segment->buffer_info).succeeded();
@@ -182,6 +282,12 @@ bool RpcSession::ReturnBuffer(TraceFileSegment* segment) {
   DCHECK(IsTracing());
   DCHECK(segment != NULL);
 
+  // As ReturnBuffer does, clear the description of the returned buffer.
+  if (QueueFullBuffer(segment)) {
+    ::memset(&segment->buffer_info, 0, sizeof(segment->buffer_info));
+    return true;
+  }
+
   return ::common::rpc::InvokeRpc(CallTraceClient_ReturnBuffer, session_handle_,
                                   &segment->buffer_info).succeeded();
 }
@@ -201,6 +307,19 @@ bool RpcSession::CloseSession() {
 void RpcSession::FreeSharedMemory() {
   base::AutoLock scoped_lock_(shared_memory_lock_);
 
+  if (buffer_exchange_ != NULL) {
+    if (::UnmapViewOfFile(buffer_exchange_) == 0) {
+      DWORD error = ::GetLastError();
+      LOG(WARNING) << "Failed to unmap buffer exchange: "
+                   << ::common::LogWe(error);
+    }
+    ignore_result(::CloseHandle(buffer_exchange_handle_));
+    ignore_result(::CloseHandle(buffer_exchange_event_));
+    buffer_exchange_handle_ = NULL;
+    buffer_exchange_ = NULL;
+    buffer_exchange_event_ = NULL;
+  }
+
   if (shared_memory_handles_.empty())
     return;
 
@@ -22,6 +22,7 @@
 #include "base/logging.h"
 #include "base/synchronization/lock.h"
 #include "syzygy/trace/client/client_utils.h"
+#include "syzygy/trace/common/buffer_exchange.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
 
 namespace trace {
@@ -75,6 +76,27 @@ class RpcSession {
   // Map a tracefile segment buffer into local memory.
   bool MapSegmentBuffer(TraceFileSegment* segment);
 
+  // Opens the buffer exchange of the session. Buffers are exchanged through
+  // RPCs only if this fails, which it does with services that predate it.
+  // @returns true on success, false otherwise.
+  bool OpenBufferExchange();
+
+  // Takes a fresh buffer from the buffer exchange, waking the service if it
+  // needs to restock it.
+  // @param segment receives the description of the buffer. It still needs
+  //     to be mapped.
+  // @returns true on success, false if no buffer was available.
+  bool TakeFreeBuffer(TraceFileSegment* segment);
+
+  // Queues the buffer of @p segment in the buffer exchange, waking the
+  // service if enough buffers are queued.
+  // @param segment the segment whose buffer is queued.
+  // @returns true on success, false if there was no room for it.
+  bool QueueFullBuffer(TraceFileSegment* segment);
+
+  // Wakes the service to drain and restock the buffer exchange.
+  void SignalBufferExchange();
+
   // The call trace RPC binding.
   handle_t rpc_binding_;
 
@@ -95,6 +117,13 @@ class RpcSession {
   base::Lock shared_memory_lock_;
   SharedMemoryHandleMap shared_memory_handles_;
 
+  // The buffer exchange shared with the service, the shared memory holding
+  // it, and the event through which the service is woken. These are set up
+  // when the session is created, and are otherwise NULL.
+  HANDLE buffer_exchange_handle_;
+  trace::common::BufferExchange* buffer_exchange_;
+  HANDLE buffer_exchange_event_;
+
   // This becomes true if the client fails to attach to a call trace service.
   // This is used to allow the application to run even if no call trace
   // service is available.
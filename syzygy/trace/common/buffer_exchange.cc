@@ -0,0 +1,125 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/common/buffer_exchange.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace trace {
+namespace common {
+
+namespace {
+
+// The positions are mapped to slots with a mask, which keeps the mapping
+// continuous when the positions wrap around.
+const base::subtle::Atomic32 kMask = BufferRing::kCapacity - 1;
+
+}  // namespace
+
+static_assert((BufferRing::kCapacity & (BufferRing::kCapacity - 1)) == 0,
+              "The ring capacity must be a power of two.");
+
+void BufferRing::Init() {
+  head_ = 0;
+  tail_ = 0;
+  for (size_t i = 0; i < kCapacity; ++i) {
+    cells_[i].sequence = static_cast<base::subtle::Atomic32>(i);
+    ::memset(&cells_[i].buffer, 0, sizeof(cells_[i].buffer));
+  }
+}
+
+bool BufferRing::Push(const ::CallTraceBuffer& buffer) {
+  base::subtle::Atomic32 position = base::subtle::NoBarrier_Load(&tail_);
+  Cell* cell = nullptr;
+  while (true) {
+    cell = &cells_[position & kMask];
+    int32_t distance =
+        Distance(base::subtle::Acquire_Load(&cell->sequence), position);
+    if (distance == 0) {
+      // The slot is free, try to claim it.
+      base::subtle::Atomic32 previous =
+          base::subtle::NoBarrier_CompareAndSwap(&tail_, position,
+                                                 position + 1);
+      if (previous == position)
+        break;
+      position = previous;
+    } else if (distance < 0) {
+      // The slot still holds the descriptor pushed one lap ago.
+      return false;
+    } else {
+      // Another producer claimed the slot, catch up.
+      position = base::subtle::NoBarrier_Load(&tail_);
+    }
+  }
+
+  cell->buffer = buffer;
+  base::subtle::Release_Store(&cell->sequence, position + 1);
+  return true;
+}
+
+bool BufferRing::Pop(::CallTraceBuffer* buffer) {
+  DCHECK(buffer != nullptr);
+
+  base::subtle::Atomic32 position = base::subtle::NoBarrier_Load(&head_);
+  Cell* cell = nullptr;
+  while (true) {
+    cell = &cells_[position & kMask];
+    int32_t distance =
+        Distance(base::subtle::Acquire_Load(&cell->sequence), position + 1);
+    if (distance == 0) {
+      // The slot holds a descriptor, try to claim it.
+      base::subtle::Atomic32 previous =
+          base::subtle::NoBarrier_CompareAndSwap(&head_, position,
+                                                 position + 1);
+      if (previous == position)
+        break;
+      position = previous;
+    } else if (distance < 0) {
+      // The slot hasn't been pushed to yet.
+      return false;
+    } else {
+      // Another consumer claimed the slot, catch up.
+      position = base::subtle::NoBarrier_Load(&head_);
+    }
+  }
+
+  *buffer = cell->buffer;
+  base::subtle::Release_Store(&cell->sequence, position + kMask + 1);
+  return true;
+}
+
+size_t BufferRing::size() const {
+  // Read the head first, so that the difference can't be negative. The
+  // other process may have scribbled over the positions, so the result is
+  // clamped to the capacity.
+  base::subtle::Atomic32 head = base::subtle::Acquire_Load(&head_);
+  base::subtle::Atomic32 tail = base::subtle::Acquire_Load(&tail_);
+  int32_t size = Distance(tail, head);
+  if (size < 0)
+    return 0;
+  return std::min(static_cast<size_t>(size), kCapacity);
+}
+
+// static
+int32_t BufferRing::Distance(base::subtle::Atomic32 sequence,
+                             base::subtle::Atomic32 position) {
+  // Positions eventually wrap around, so this is computed modulo 2^32.
+  return static_cast<int32_t>(static_cast<uint32_t>(sequence) -
+                              static_cast<uint32_t>(position));
+}
+
+}  // namespace common
+}  // namespace trace
@@ -0,0 +1,117 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Declares the shared memory structures through which a call trace client
+// and the call trace service exchange buffers without an RPC round trip.
+//
+// The service hands fresh buffers to the client through the free ring, and
+// the client hands full buffers back through the full ring. Each ring is a
+// bounded lock-free queue of CallTraceBuffer descriptors: every slot carries
+// a sequence number telling producers and consumers whose turn it is to use
+// it, so claiming a slot is a single compare-and-swap of the head or tail
+// position. This lets any number of client threads use the rings at once.
+//
+// The client signals an event shared with the service only when the rings
+// cross the thresholds below, and falls back to the ExchangeBuffer RPC when
+// the free ring is empty or the full ring is full. The service otherwise
+// services the rings periodically.
+//
+// NOTE: The client may write anything to this memory, so the service must
+//     validate every descriptor it pops, exactly as it would those it gets
+//     through RPCs.
+
+#ifndef SYZYGY_TRACE_COMMON_BUFFER_EXCHANGE_H_
+#define SYZYGY_TRACE_COMMON_BUFFER_EXCHANGE_H_
+
+#include <stdint.h>
+
+#include "base/atomicops.h"
+#include "syzygy/trace/rpc/call_trace_rpc.h"
+
+namespace trace {
+namespace common {
+
+// A bounded lock-free queue of buffer descriptors, laid out to live in memory
+// shared by two processes. It has no constructor; Init must be called by its
+// creator before the memory is shared.
+class BufferRing {
+ public:
+  // The number of slots of the ring. This must be a power of two.
+  static const size_t kCapacity = 32;
+
+  // Initializes an empty ring.
+  void Init();
+
+  // Appends a descriptor to the ring, if there's room.
+  // @param buffer the descriptor to append.
+  // @returns true on success, false if the ring is full.
+  bool Push(const ::CallTraceBuffer& buffer);
+
+  // Removes the oldest descriptor from the ring, if any.
+  // @param buffer receives the removed descriptor.
+  // @returns true on success, false if the ring is empty.
+  bool Pop(::CallTraceBuffer* buffer);
+
+  // @returns the number of descriptors in the ring. This is only a snapshot
+  //     when the ring is being used concurrently.
+  size_t size() const;
+
+ private:
+  // A slot of the ring. A slot is free for the push at position p when its
+  // sequence is p, and holds the descriptor to pop at position p when its
+  // sequence is p + 1. Popping it makes it free for the push at position
+  // p + kCapacity.
+  struct Cell {
+    base::subtle::Atomic32 sequence;
+    ::CallTraceBuffer buffer;
+  };
+
+  // @returns the difference between a sequence number and a position.
+  static int32_t Distance(base::subtle::Atomic32 sequence,
+                          base::subtle::Atomic32 position);
+
+  // The position of the next descriptor to pop. The positions are padded to
+  // a cache line to avoid false sharing between producers and consumers.
+  base::subtle::Atomic32 head_;
+  uint8_t head_padding_[64 - sizeof(base::subtle::Atomic32)];
+
+  // The position of the next descriptor to push.
+  base::subtle::Atomic32 tail_;
+  uint8_t tail_padding_[64 - sizeof(base::subtle::Atomic32)];
+
+  Cell cells_[kCapacity];
+};
+
+// The memory shared by a client and the service for a session.
+struct BufferExchange {
+  // The number of fresh buffers the service keeps in the free ring.
+  static const size_t kFreeBufferTarget = BufferRing::kCapacity / 2;
+
+  // The client wakes the service when it leaves this many fresh buffers.
+  static const size_t kFreeBufferLowWater = BufferRing::kCapacity / 8;
+
+  // The client wakes the service when it has queued this many full buffers.
+  static const size_t kFullBufferHighWater = BufferRing::kCapacity / 2;
+
+  // Fresh buffers, pushed by the service and popped by the client.
+  BufferRing free_buffers;
+
+  // Full buffers, pushed by the client and popped by the service.
+  BufferRing full_buffers;
+};
+
+}  // namespace common
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_COMMON_BUFFER_EXCHANGE_H_
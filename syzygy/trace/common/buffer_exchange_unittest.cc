@@ -0,0 +1,127 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/common/buffer_exchange.h"
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
+#include "gtest/gtest.h"
+
+namespace trace {
+namespace common {
+
+namespace {
+
+::CallTraceBuffer MakeBuffer(unsigned long offset) {
+  ::CallTraceBuffer buffer = {};
+  buffer.shared_memory_handle = 0x1234;
+  buffer.mapping_size = 0x100000;
+  buffer.buffer_offset = offset;
+  buffer.buffer_size = 0x1000;
+  return buffer;
+}
+
+// Pushes a range of offsets to a ring, popping a descriptor after each push.
+class RingUser : public base::DelegateSimpleThread::Delegate {
+ public:
+  RingUser(BufferRing* ring, unsigned long first_offset, size_t count)
+      : ring_(ring), first_offset_(first_offset), count_(count) {
+  }
+
+  void Run() override {
+    for (size_t i = 0; i < count_; ++i) {
+      while (!ring_->Push(MakeBuffer(first_offset_ + i)))
+        base::PlatformThread::YieldCurrentThread();
+      ::CallTraceBuffer buffer = {};
+      while (!ring_->Pop(&buffer))
+        base::PlatformThread::YieldCurrentThread();
+      popped_.push_back(buffer.buffer_offset);
+    }
+  }
+
+  const std::vector<unsigned long>& popped() const { return popped_; }
+
+ private:
+  BufferRing* ring_;
+  unsigned long first_offset_;
+  size_t count_;
+  std::vector<unsigned long> popped_;
+};
+
+}  // namespace
+
+TEST(BufferRingTest, PushAndPopInOrder) {
+  std::unique_ptr<BufferRing> ring(new BufferRing());
+  ring->Init();
+  EXPECT_EQ(0u, ring->size());
+
+  ::CallTraceBuffer buffer = {};
+  EXPECT_FALSE(ring->Pop(&buffer));
+
+  // Go around the ring a few times.
+  for (size_t lap = 0; lap < 3; ++lap) {
+    for (size_t i = 0; i < BufferRing::kCapacity; ++i) {
+      EXPECT_TRUE(ring->Push(MakeBuffer(i)));
+      EXPECT_EQ(i + 1, ring->size());
+    }
+    EXPECT_FALSE(ring->Push(MakeBuffer(0)));
+
+    for (size_t i = 0; i < BufferRing::kCapacity; ++i) {
+      ASSERT_TRUE(ring->Pop(&buffer));
+      EXPECT_EQ(0x1234u, buffer.shared_memory_handle);
+      EXPECT_EQ(0x100000u, buffer.mapping_size);
+      EXPECT_EQ(i, buffer.buffer_offset);
+      EXPECT_EQ(0x1000u, buffer.buffer_size);
+    }
+    EXPECT_FALSE(ring->Pop(&buffer));
+    EXPECT_EQ(0u, ring->size());
+  }
+}
+
+TEST(BufferRingTest, ConcurrentUse) {
+  const size_t kThreadCount = 4;
+  const size_t kBuffersPerThread = 1000;
+
+  std::unique_ptr<BufferRing> ring(new BufferRing());
+  ring->Init();
+
+  std::vector<std::unique_ptr<RingUser>> users;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    users.push_back(std::unique_ptr<RingUser>(new RingUser(
+        ring.get(), static_cast<unsigned long>(i * kBuffersPerThread),
+        kBuffersPerThread)));
+    threads.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(users.back().get(), "ring-user")));
+    threads.back()->Start();
+  }
+  for (auto& thread : threads)
+    thread->Join();
+
+  // Every descriptor pushed must have been popped exactly once.
+  std::multiset<unsigned long> popped;
+  for (auto& user : users)
+    popped.insert(user->popped().begin(), user->popped().end());
+  EXPECT_EQ(kThreadCount * kBuffersPerThread, popped.size());
+  for (unsigned long i = 0; i < kThreadCount * kBuffersPerThread; ++i)
+    EXPECT_EQ(1u, popped.count(i));
+  EXPECT_EQ(0u, ring->size());
+}
+
+}  // namespace common
+}  // namespace trace
@@ -33,6 +33,8 @@
       'target_name': 'trace_common_lib',
       'type': 'static_library',
       'sources': [
+        'buffer_exchange.cc',
+        'buffer_exchange.h',
         'clock.cc',
         'clock.h',
         'service.cc',
@@ -43,12 +45,14 @@
       'dependencies': [
         '<(src)/base/base.gyp:base',
         '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/trace/rpc/rpc.gyp:call_trace_rpc_lib',
       ],
     },
     {
       'target_name': 'trace_common_unittests',
       'type': 'executable',
       'sources': [
+        'buffer_exchange_unittest.cc',
         'clock_unittest.cc',
         'service_unittest.cc',
         'service_util_unittest.cc',
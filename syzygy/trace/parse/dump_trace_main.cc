@@ -482,6 +482,28 @@ class TraceFileDumper : public ParseEventHandler {
               time.ToInternalValue(), process_id, data->process_heap);
   }
 
+  void OnHeapAllocationSnapshot(
+      base::Time time,
+      DWORD process_id,
+      const TraceHeapAllocationSnapshot* data) override {
+    DCHECK_NE(static_cast<TraceHeapAllocationSnapshot*>(nullptr), data);
+    ::fprintf(file_,
+              "[%012lld] OnHeapAllocationSnapshot: process-id=%d; "
+              "snapshot-id=%d; num-stats=%d\n",
+              time.ToInternalValue(), process_id, data->snapshot_id,
+              data->num_stats);
+    for (size_t i = 0; i < data->num_stats; ++i) {
+      const TraceHeapAllocationStats& stats = data->stats[i];
+      ::fprintf(file_,
+                "%sstack-trace-id=0x%08X; size-class=%d; live-count=%d; "
+                "live-bytes=%d; alloc-count=%d; free-count=%d; "
+                "alloc-bytes=%lld\n",
+                indentation_, stats.stack_trace_id, stats.size_class,
+                stats.live_count, stats.live_bytes, stats.alloc_count,
+                stats.free_count, stats.alloc_bytes);
+    }
+  }
+
  private:
   FILE* file_;
   const char* indentation_;
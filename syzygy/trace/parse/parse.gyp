@@ -31,6 +31,7 @@
         'parser.cc',
       ],
       'dependencies': [
+        '<(src)/syzygy/core/core.gyp:core_lib',
         '<(src)/syzygy/pe/pe.gyp:pe_lib',
         '<(src)/syzygy/trace/common/common.gyp:trace_common_lib',
         '<(src)/syzygy/trace/rpc/rpc.gyp:call_trace_rpc_lib',
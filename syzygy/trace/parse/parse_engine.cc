@@ -271,6 +271,10 @@ bool ParseEngine::DispatchEvent(EVENT_TRACE* event) {
       success = DispatchProcessHeap(event);
       break;
 
+    case TRACE_HEAP_ALLOCATION_SNAPSHOT:
+      success = DispatchHeapAllocationSnapshot(event);
+      break;
+
     default:
       LOG(ERROR) << "Unknown event type encountered.";
       break;
@@ -669,6 +673,37 @@ bool ParseEngine::DispatchProcessHeap(EVENT_TRACE* event) {
   return true;
 }
 
+bool ParseEngine::DispatchHeapAllocationSnapshot(EVENT_TRACE* event) {
+  DCHECK_NE(static_cast<EVENT_TRACE*>(nullptr), event);
+  DCHECK_NE(static_cast<ParseEventHandler*>(nullptr), event_handler_);
+  DCHECK(!error_occurred_);
+
+  BinaryBufferReader reader(event->MofData, event->MofLength);
+  const TraceHeapAllocationSnapshot* data = nullptr;
+  if (!reader.Read(FIELD_OFFSET(TraceHeapAllocationSnapshot, stats), &data)) {
+    LOG(ERROR) << "Short or empty TraceHeapAllocationSnapshot event.";
+    return false;
+  }
+  DCHECK(data != nullptr);
+
+  // Calculate the expected size of the payload and ensure there's
+  // enough data.
+  size_t expected_length = FIELD_OFFSET(TraceHeapAllocationSnapshot, stats) +
+      data->num_stats * sizeof(TraceHeapAllocationStats);
+  if (event->MofLength < expected_length) {
+    LOG(ERROR) << "Payload smaller than size implied by "
+               << "TraceHeapAllocationSnapshot header.";
+    return false;
+  }
+
+  base::Time time(base::Time::FromFileTime(
+      reinterpret_cast<FILETIME&>(event->Header.TimeStamp)));
+  DWORD process_id = event->Header.ProcessId;
+  event_handler_->OnHeapAllocationSnapshot(time, process_id, data);
+
+  return true;
+}
+
 namespace {
 
 void ModuleTraceDataToModuleInformation(
@@ -47,6 +47,11 @@ class ParseEngine {
   // Registers an event handler with this trace-file parse engine.
   void set_event_handler(ParseEventHandler* event_handler);
 
+  // Restricts the segments parsed, in trace files with a segment index.
+  void set_segment_filter(const SegmentFilter& filter) {
+    segment_filter_ = filter;
+  }
+
   // Returns true if the file given by @p trace_file_path is parseable by this
   // parse engine.
   virtual bool IsRecognizedTraceFile(const base::FilePath& trace_file_path) = 0;
@@ -245,12 +250,21 @@ class ParseEngine {
   //     Does not explicitly set error occurred.
   bool DispatchProcessHeap(EVENT_TRACE* event);
 
+  // Parses and dispatches a heap allocation snapshot record.
+  // @param event the event to dispatch.
+  // @returns true if the event was successfully dispatched, false otherwise.
+  //     Does not explicitly set error occurred.
+  bool DispatchHeapAllocationSnapshot(EVENT_TRACE* event);
+
   // The name by which this parse engine is known.
   std::string name_;
 
   // The event handler to be notified on trace events.
   ParseEventHandler* event_handler_;
 
+  // The filter of the segments to parse.
+  SegmentFilter segment_filter_;
+
   // For each process, we store its point of view of the world.
   ProcessMap processes_;
 
@@ -16,18 +16,283 @@
 
 #include "syzygy/trace/parse/parse_engine_rpc.h"
 
+#include <stddef.h>
+
+#include <algorithm>
+#include <vector>
+
 #include "base/logging.h"
 #include "base/files/file_util.h"
+#include "base/win/scoped_handle.h"
 #include "syzygy/common/align.h"
 #include "syzygy/common/com_utils.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/core/zstream.h"
 #include "syzygy/trace/parse/parse_utils.h"
 
-using common::AlignUp;
 using common::AlignUp64;
 
 namespace trace {
 namespace parser {
 
+namespace {
+
+// The size of the windows of the trace files that are mapped at once. The
+// trace files may be larger than the address space.
+const size_t kViewSize = 64 * 1024 * 1024;
+
+// The declarations of PrefetchVirtualMemory, which is only available as of
+// Windows 8.
+struct MemoryRangeEntry {
+  void* virtual_address;
+  size_t number_of_bytes;
+};
+typedef BOOL (WINAPI* PrefetchVirtualMemoryFunc)(HANDLE process,
+                                                 ULONG_PTR number_of_entries,
+                                                 MemoryRangeEntry* entries,
+                                                 ULONG flags);
+
+// Maps a trace file for reading, a window at a time. The trace file is usually
+// read from start to end, so each window is prefetched as it is mapped unless
+// asked otherwise.
+class MappedTraceFile {
+ public:
+  MappedTraceFile()
+      : size_(0),
+        allocation_granularity_(0),
+        prefetch_virtual_memory_(NULL),
+        prefetch_(true),
+        view_(NULL),
+        view_offset_(0),
+        view_size_(0) {
+  }
+
+  ~MappedTraceFile() {
+    Unmap();
+  }
+
+  // Opens and maps a trace file.
+  // @param path the path of the trace file.
+  // @returns true on success, false otherwise.
+  bool Open(const base::FilePath& path) {
+    file_.Set(::CreateFile(path.value().c_str(), GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (!file_.IsValid()) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Unable to open '" << path.value() << "': "
+                 << ::common::LogWe(error) << ".";
+      return false;
+    }
+
+    LARGE_INTEGER size = {};
+    if (!::GetFileSizeEx(file_.Get(), &size)) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Unable to get the size of '" << path.value() << "': "
+                 << ::common::LogWe(error) << ".";
+      return false;
+    }
+    size_ = size.QuadPart;
+
+    // Empty files can't be mapped, and aren't trace files anyway.
+    if (size_ == 0) {
+      LOG(ERROR) << "'" << path.value() << "' is empty.";
+      return false;
+    }
+
+    mapping_.Set(::CreateFileMapping(file_.Get(), NULL, PAGE_READONLY, 0, 0,
+                                     NULL));
+    if (!mapping_.IsValid()) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Unable to map '" << path.value() << "': "
+                 << ::common::LogWe(error) << ".";
+      return false;
+    }
+
+    SYSTEM_INFO system_info = {};
+    ::GetSystemInfo(&system_info);
+    allocation_granularity_ = system_info.dwAllocationGranularity;
+
+    prefetch_virtual_memory_ = reinterpret_cast<PrefetchVirtualMemoryFunc>(
+        ::GetProcAddress(::GetModuleHandle(L"kernel32.dll"),
+                         "PrefetchVirtualMemory"));
+
+    return true;
+  }
+
+  // @returns the size of the trace file.
+  uint64_t size() const { return size_; }
+
+  // Sets whether each window is prefetched as it is mapped. This only pays
+  // off when most of each window is read.
+  void set_prefetch(bool prefetch) { prefetch_ = prefetch; }
+
+  // Gets a range of the trace file, mapping it if need be.
+  // @param offset the offset of the range.
+  // @param length the length of the range.
+  // @returns a pointer to the range, which is valid until the next call, or
+  //     NULL if the range is past the end of the file or can't be mapped.
+  const uint8_t* GetRange(uint64_t offset, size_t length) {
+    if (offset > size_ || length > size_ - offset)
+      return NULL;
+
+    if (view_ == NULL || offset < view_offset_ ||
+        offset + length > view_offset_ + view_size_) {
+      // Views must start on a multiple of the allocation granularity.
+      Unmap();
+      uint64_t view_offset = offset - offset % allocation_granularity_;
+      uint64_t view_end = std::min(
+          size_, std::max<uint64_t>(view_offset + kViewSize, offset + length));
+      size_t view_size = static_cast<size_t>(view_end - view_offset);
+      view_ = reinterpret_cast<uint8_t*>(::MapViewOfFile(
+          mapping_.Get(), FILE_MAP_READ, static_cast<DWORD>(view_offset >> 32),
+          static_cast<DWORD>(view_offset), view_size));
+      if (view_ == NULL) {
+        DWORD error = ::GetLastError();
+        LOG(ERROR) << "Unable to map view of trace file: "
+                   << ::common::LogWe(error) << ".";
+        return NULL;
+      }
+      view_offset_ = view_offset;
+      view_size_ = view_size;
+
+      // Ask for the whole view to be read in, rather than page by page as
+      // it's touched. This is only a hint, so failures are ignored.
+      if (prefetch_ && prefetch_virtual_memory_ != NULL) {
+        MemoryRangeEntry entry = { view_, view_size_ };
+        prefetch_virtual_memory_(::GetCurrentProcess(), 1, &entry, 0);
+      }
+    }
+
+    return view_ + (offset - view_offset_);
+  }
+
+ private:
+  void Unmap() {
+    if (view_ != NULL) {
+      ::UnmapViewOfFile(view_);
+      view_ = NULL;
+    }
+  }
+
+  base::win::ScopedHandle file_;
+  base::win::ScopedHandle mapping_;
+  uint64_t size_;
+  DWORD allocation_granularity_;
+  PrefetchVirtualMemoryFunc prefetch_virtual_memory_;
+  bool prefetch_;
+
+  // The currently mapped view, if any.
+  uint8_t* view_;
+  uint64_t view_offset_;
+  size_t view_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedTraceFile);
+};
+
+// Decompresses the data of a compressed segment.
+bool DecompressSegment(const uint8_t* data,
+                       size_t length,
+                       size_t uncompressed_length,
+                       std::vector<uint8_t>* segment) {
+  DCHECK(data != NULL);
+  DCHECK(segment != NULL);
+
+  segment->resize(uncompressed_length);
+  core::ScopedInStreamPtr in_stream(
+      core::CreateByteInStream(data, data + length));
+  core::ZInStream unzip_stream(in_stream.get());
+  size_t bytes_read = 0;
+  if (!unzip_stream.Init() ||
+      !unzip_stream.Read(segment->size(), segment->data(), &bytes_read) ||
+      bytes_read != segment->size()) {
+    LOG(ERROR) << "Failed to decompress segment.";
+    return false;
+  }
+
+  return true;
+}
+
+// Reads the segment index of a trace file, as located by the trailer at its
+// end.
+// @param trace_file the trace file.
+// @param file_header the header of the trace file.
+// @param entries receives the entries of the segment index.
+// @returns true on success, false if the trace file has no valid index.
+bool ReadSegmentIndex(MappedTraceFile* trace_file,
+                      const TraceFileHeader& file_header,
+                      std::vector<TraceFileSegmentIndexEntry>* entries) {
+  DCHECK(trace_file != NULL);
+  DCHECK(entries != NULL);
+
+  if ((file_header.flags & TraceFileHeader::kSegmentIndex) == 0)
+    return false;
+  if (trace_file->size() < sizeof(TraceFileSegmentIndexTrailer))
+    return false;
+
+  const uint8_t* data = trace_file->GetRange(
+      trace_file->size() - sizeof(TraceFileSegmentIndexTrailer),
+      sizeof(TraceFileSegmentIndexTrailer));
+  if (data == NULL)
+    return false;
+  TraceFileSegmentIndexTrailer trailer = {};
+  ::memcpy(&trailer, data, sizeof(trailer));
+  if (::memcmp(&trailer.signature,
+               &TraceFileSegmentIndexTrailer::kSignatureValue,
+               sizeof(trailer.signature)) != 0) {
+    return false;
+  }
+
+  // The index must lie between the header and the trailer.
+  const size_t kIndexHeaderLength = sizeof(RecordPrefix) +
+      offsetof(TraceFileSegmentIndex, entries);
+  uint64_t index_end = trace_file->size() - sizeof(trailer);
+  if (trailer.index_offset < file_header.header_size ||
+      trailer.index_offset > index_end ||
+      index_end - trailer.index_offset < kIndexHeaderLength) {
+    return false;
+  }
+
+  data = trace_file->GetRange(trailer.index_offset, kIndexHeaderLength);
+  if (data == NULL)
+    return false;
+  RecordPrefix prefix = {};
+  ::memcpy(&prefix, data, sizeof(prefix));
+  uint32_t num_entries = 0;
+  ::memcpy(&num_entries,
+           data + sizeof(prefix) +
+               offsetof(TraceFileSegmentIndex, num_entries),
+           sizeof(num_entries));
+  if (prefix.type != TraceFileSegmentIndex::kTypeId ||
+      prefix.version.hi != TRACE_VERSION_HI ||
+      prefix.version.lo != TRACE_VERSION_LO ||
+      num_entries > (index_end - trailer.index_offset - kIndexHeaderLength) /
+                        sizeof(TraceFileSegmentIndexEntry)) {
+    return false;
+  }
+
+  size_t entries_length = num_entries * sizeof(TraceFileSegmentIndexEntry);
+  data = trace_file->GetRange(trailer.index_offset + kIndexHeaderLength,
+                              entries_length);
+  if (data == NULL)
+    return false;
+  entries->resize(num_entries);
+  if (num_entries != 0)
+    ::memcpy(entries->data(), data, entries_length);
+
+  // The segments must precede the index.
+  for (const TraceFileSegmentIndexEntry& entry : *entries) {
+    if (entry.offset < file_header.header_size ||
+        entry.offset >= trailer.index_offset) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
 ParseEngineRpc::ParseEngineRpc() : ParseEngine("RPC", true) {
 }
 
@@ -86,30 +351,18 @@ bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
 
   LOG(INFO) << "Processing '" << trace_file_path.BaseName().value() << "'.";
 
-  base::ScopedFILE trace_file(base::OpenFile(trace_file_path, "rb"));
-  if (!trace_file.get()) {
-    DWORD error = ::GetLastError();
-    LOG(ERROR) << "Unable to open '" << trace_file_path.value() << "': "
-               << ::common::LogWe(error) << ".";
+  MappedTraceFile trace_file;
+  if (!trace_file.Open(trace_file_path))
     return false;
-  }
-
-  // Let's reserve some space for the variable length header.
-  const size_t kReasonableHeaderSize = 4096;
-  std::vector<uint8_t> raw_buffer;
-  raw_buffer.reserve(kReasonableHeaderSize);
-  raw_buffer.resize(sizeof(TraceFileHeader));
 
-  // Populate the buffer.
-  DCHECK_EQ(raw_buffer.size(), sizeof(TraceFileHeader));
-  size_t bytes_read = ::fread(&raw_buffer[0],
-                              1,
-                              raw_buffer.size(),
-                              trace_file.get());
-  if (bytes_read != raw_buffer.size()) {
+  // Copy the header, as the view it's mapped in is replaced as the segments
+  // are read.
+  const uint8_t* data = trace_file.GetRange(0, sizeof(TraceFileHeader));
+  if (data == NULL) {
     LOG(ERROR) << "Failed to read trace file header.";
     return false;
   }
+  std::vector<uint8_t> raw_buffer(data, data + sizeof(TraceFileHeader));
 
   // Create a typed alias to the raw buffer.
   const TraceFileHeader* file_header =
@@ -123,20 +376,17 @@ bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
     return false;
   }
 
-  // Make sure there's enough room for the variable length part of the header
-  // and then append read the rest of the header. Note that the underlying raw
-  // buffer might move when it is resized.
-  size_t bytes_to_read = file_header->header_size - raw_buffer.size();
-  raw_buffer.resize(file_header->header_size);
-  file_header = reinterpret_cast<const TraceFileHeader*>(&raw_buffer[0]);
-  bytes_read = ::fread(&raw_buffer[sizeof(TraceFileHeader)],
-                       1,
-                       bytes_to_read,
-                       trace_file.get());
-  if (bytes_read != bytes_to_read) {
+  // Read the variable length part of the header. Note that the underlying raw
+  // buffer might move when it is assigned.
+  data = NULL;
+  if (file_header->header_size >= sizeof(TraceFileHeader))
+    data = trace_file.GetRange(0, file_header->header_size);
+  if (data == NULL) {
     LOG(ERROR) << "Failed to read trace file header.";
     return false;
   }
+  raw_buffer.assign(data, data + file_header->header_size);
+  file_header = reinterpret_cast<const TraceFileHeader*>(&raw_buffer[0]);
 
   // Populate the system information which will be fed to the OnProcessStarted
   // event.
@@ -173,70 +423,115 @@ bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
   event_handler_->OnProcessStarted(start_time, file_header->process_id,
                                    &system_info);
 
-  // Consume the body of the trace file.
+  // When filtering segments, the segment index tells which segments to visit.
+  // Trace files without one are parsed in full.
+  std::vector<TraceFileSegmentIndexEntry> segment_index;
+  bool use_segment_index = false;
+  if (!segment_filter_.IsEmpty()) {
+    use_segment_index =
+        ReadSegmentIndex(&trace_file, *file_header, &segment_index);
+    if (use_segment_index) {
+      // Only a few pages of each window may be read.
+      trace_file.set_prefetch(false);
+    } else {
+      LOG(INFO) << "No segment index, parsing all segments.";
+    }
+  }
+
+  // Consume the body of the trace file. The events of uncompressed segments
+  // are dispatched straight from the mapping of the trace file.
   uint64_t next_segment =
       AlignUp64(file_header->header_size, file_header->block_size);
-  std::unique_ptr<uint8_t[]> buffer;
-  size_t buffer_size = 0;
+  size_t next_index_entry = 0;
+  std::vector<uint8_t> uncompressed_buffer;
   while (true) {
-    if (::_fseeki64(trace_file.get(), next_segment, SEEK_SET) != 0) {
-      LOG(ERROR) << "Failed to seek segment boundary " << next_segment << ".";
-      return false;
-    }
-
-    RecordPrefix segment_prefix;
-    if (::fread(&segment_prefix,
-                sizeof(segment_prefix),
-                1,
-                trace_file.get()) != 1) {
-      if (::feof(trace_file.get()))
+    if (use_segment_index) {
+      while (next_index_entry < segment_index.size() &&
+             !segment_filter_.Matches(segment_index[next_index_entry])) {
+        ++next_index_entry;
+      }
+      if (next_index_entry == segment_index.size())
         break;
+      next_segment = segment_index[next_index_entry++].offset;
+    }
+    if (next_segment >= trace_file.size() ||
+        trace_file.size() - next_segment < sizeof(RecordPrefix)) {
+      break;
+    }
 
+    data = trace_file.GetRange(next_segment, sizeof(RecordPrefix));
+    if (data == NULL) {
       LOG(ERROR) << "Failed to read segment header prefix.";
       return false;
     }
+    RecordPrefix segment_prefix = {};
+    ::memcpy(&segment_prefix, data, sizeof(segment_prefix));
+
+    // The segment index, if any, follows the last segment.
+    if ((file_header->flags & TraceFileHeader::kSegmentIndex) != 0 &&
+        segment_prefix.type == TraceFileSegmentIndex::kTypeId) {
+      break;
+    }
 
-    if (segment_prefix.type != TraceFileSegmentHeader::kTypeId ||
-        segment_prefix.size != sizeof(TraceFileSegmentHeader) ||
-        segment_prefix.version.hi != TRACE_VERSION_HI ||
+    bool compressed = false;
+    if ((file_header->flags & TraceFileHeader::kCompressedSegments) != 0 &&
+        segment_prefix.type == TraceFileCompressedSegmentHeader::kTypeId &&
+        segment_prefix.size == sizeof(TraceFileCompressedSegmentHeader)) {
+      compressed = true;
+    } else if (segment_prefix.type != TraceFileSegmentHeader::kTypeId ||
+               segment_prefix.size != sizeof(TraceFileSegmentHeader)) {
+      LOG(ERROR) << "Unrecognized record prefix for segment header.";
+      return false;
+    }
+    if (segment_prefix.version.hi != TRACE_VERSION_HI ||
         segment_prefix.version.lo != TRACE_VERSION_LO) {
       LOG(ERROR) << "Unrecognized record prefix for segment header.";
       return false;
     }
 
-    TraceFileSegmentHeader segment_header;
-    if (::fread(&segment_header,
-                sizeof(segment_header),
-                1,
-                trace_file.get()) != 1) {
+    // Both kinds of segment headers start with the same fields.
+    const size_t kHeaderLength = sizeof(segment_prefix) + segment_prefix.size;
+    data = trace_file.GetRange(next_segment, kHeaderLength);
+    if (data == NULL) {
       LOG(ERROR) << "Failed to read segment header.";
       return false;
     }
-
-    size_t aligned_size = AlignUp(segment_header.segment_length,
-                                  file_header->block_size);
-
-    if (aligned_size > buffer_size) {
-      buffer.reset(new uint8_t[aligned_size]);
-      buffer_size = aligned_size;
-    }
-
-    if (::fread(buffer.get(), segment_header.segment_length, 1,
-                trace_file.get()) != 1) {
+    TraceFileCompressedSegmentHeader compressed_header = {};
+    ::memcpy(&compressed_header, data + sizeof(segment_prefix),
+             segment_prefix.size);
+    TraceFileSegmentHeader segment_header = {};
+    segment_header.thread_id = compressed_header.thread_id;
+    segment_header.segment_length = compressed_header.segment_length;
+
+    data = trace_file.GetRange(next_segment,
+                               kHeaderLength + segment_header.segment_length);
+    if (data == NULL) {
       LOG(ERROR) << "Failed to read segment.";
       return false;
     }
 
+    const uint8_t* segment = data + kHeaderLength;
+    if (compressed) {
+      segment_header.segment_length = compressed_header.uncompressed_length;
+      if (!DecompressSegment(segment, compressed_header.segment_length,
+                             compressed_header.uncompressed_length,
+                             &uncompressed_buffer)) {
+        return false;
+      }
+      segment = uncompressed_buffer.data();
+    }
+
     if (!ConsumeSegmentEvents(*file_header,
                               segment_header,
-                              buffer.get(),
+                              segment,
                               segment_header.segment_length)) {
       return false;
     }
 
+    // The segment takes up its length on disk, which is the compressed one
+    // for compressed segments.
     next_segment = AlignUp64(
-        next_segment + sizeof(segment_prefix) + sizeof(segment_header) +
-            segment_header.segment_length,
+        next_segment + kHeaderLength + compressed_header.segment_length,
         file_header->block_size);
   }
 
@@ -246,22 +541,30 @@ bool ParseEngineRpc::ConsumeTraceFile(const base::FilePath& trace_file_path) {
 bool ParseEngineRpc::ConsumeSegmentEvents(
     const TraceFileHeader& file_header,
     const TraceFileSegmentHeader& segment_header,
-    uint8_t* buffer,
+    const uint8_t* buffer,
     size_t buffer_length) {
   DCHECK(buffer != NULL);
   DCHECK(event_handler_ != NULL);
 
   EVENT_TRACE event_record = {};
+  std::vector<uint8_t> expanded_record;
 
   event_record.Header.ProcessId = file_header.process_id;
   event_record.Header.ThreadId = segment_header.thread_id;
   event_record.Header.Guid = kCallTraceEventClass;
 
-  uint8_t* read_ptr = buffer;
-  uint8_t* end_ptr = read_ptr + buffer_length;
+  const uint8_t* read_ptr = buffer;
+  const uint8_t* end_ptr = read_ptr + buffer_length;
 
   while (read_ptr < end_ptr) {
-    RecordPrefix* prefix = reinterpret_cast<RecordPrefix*>(read_ptr);
+    // The segment may end in the last page of the mapping, so the prefix
+    // itself mustn't be read past its end.
+    if (static_cast<size_t>(end_ptr - read_ptr) < sizeof(RecordPrefix)) {
+      LOG(WARNING) << "Encountered truncated record at end of segment.";
+      break;
+    }
+    const RecordPrefix* prefix =
+        reinterpret_cast<const RecordPrefix*>(read_ptr);
     read_ptr += sizeof(RecordPrefix) + prefix->size;
     if (read_ptr > end_ptr) {
       // For batch-oriented records (where the record size is updated after
@@ -282,8 +585,24 @@ bool ParseEngineRpc::ConsumeSegmentEvents(
         prefix->timestamp,
         reinterpret_cast<FILETIME*>(&event_record.Header.TimeStamp));
 
-    event_record.MofData = prefix + 1;
+    // The event handlers don't modify the events.
+    event_record.MofData = const_cast<RecordPrefix*>(prefix + 1);
     event_record.MofLength = prefix->size;
+
+    // Records in a compact encoding are dispatched in their full form.
+    if (IsCompactRecordType(prefix->type)) {
+      uint16_t type = 0;
+      if (!ExpandCompactRecord(*prefix,
+                               reinterpret_cast<const uint8_t*>(prefix + 1),
+                               segment_header.thread_id, &type,
+                               &expanded_record)) {
+        return false;
+      }
+      event_record.Header.Class.Type = type;
+      event_record.MofData = expanded_record.data();
+      event_record.MofLength = expanded_record.size();
+    }
+
     if (!DispatchEvent(&event_record)) {
       LOG(ERROR) << "Failed to process event of type " << prefix->type << ".";
       return false;
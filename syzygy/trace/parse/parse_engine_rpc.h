@@ -48,7 +48,9 @@ class ParseEngineRpc : public ParseEngine {
 
   // Dispatches all of the events contained in the given trace file.
   //
-  // For each segment in the trace file calls ConsumeSegmentEvents().
+  // The trace file is mapped into memory a window at a time, and for each
+  // segment in the trace file calls ConsumeSegmentEvents() with the mapped
+  // segment.
   //
   // @returns true on success
   bool ConsumeTraceFile(const base::FilePath& trace_file_path);
@@ -57,12 +59,13 @@ class ParseEngineRpc : public ParseEngine {
   //
   // @param file_header the header information describing the trace file.
   // @param segment_header the header information describing the segment.
-  // @param buffer the full segment data buffer.
+  // @param buffer the full segment data buffer. The events dispatched point
+  //     into it.
   // @param buffer_length the length of the segment data buffer (in bytes).
   // @return true on success.
   bool ConsumeSegmentEvents(const TraceFileHeader& file_header,
                             const TraceFileSegmentHeader& segment_header,
-                            uint8_t* buffer,
+                            const uint8_t* buffer,
                             size_t buffer_length);
 
   // The set of trace files to consume when ConsumeAllEvents() is called.
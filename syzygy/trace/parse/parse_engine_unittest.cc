@@ -222,6 +222,10 @@ class ParseEngineUnitTest
                void(base::Time time,
                     DWORD process_id,
                     const TraceProcessHeap* data));
+  MOCK_METHOD3(OnHeapAllocationSnapshot,
+               void(base::Time time,
+                    DWORD process_id,
+                    const TraceHeapAllocationSnapshot* data));
 
   static const DWORD kProcessId;
   static const DWORD kThreadId;
@@ -791,4 +795,29 @@ TEST_F(ParseEngineUnitTest, ProcessHeap) {
   ASSERT_TRUE(error_occurred());
 }
 
+TEST_F(ParseEngineUnitTest, HeapAllocationSnapshot) {
+  const size_t kNumStats = 2;
+  const size_t kDataSize = FIELD_OFFSET(TraceHeapAllocationSnapshot, stats) +
+      kNumStats * sizeof(TraceHeapAllocationStats);
+  uint8_t buffer[kDataSize] = {};
+  TraceHeapAllocationSnapshot* data =
+      reinterpret_cast<TraceHeapAllocationSnapshot*>(buffer);
+  data->snapshot_id = 3;
+  data->num_stats = kNumStats;
+  data->stats[0].stack_trace_id = 0xCAFEBABE;
+  data->stats[0].size_class = 5;
+  data->stats[1].stack_trace_id = 0xDEADBEEF;
+  data->stats[1].size_class = 10;
+
+  EXPECT_CALL(*this, OnHeapAllocationSnapshot(_, kProcessId, data));
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_HEAP_ALLOCATION_SNAPSHOT, data, sizeof(buffer)));
+  ASSERT_FALSE(error_occurred());
+
+  // Dispatch a malformed record and make sure the parser errors.
+  ASSERT_NO_FATAL_FAILURE(DispatchEventData(
+      TRACE_HEAP_ALLOCATION_SNAPSHOT, data, sizeof(buffer) - 1));
+  ASSERT_TRUE(error_occurred());
+}
+
 }  // namespace
@@ -14,6 +14,8 @@
 
 #include "syzygy/trace/parse/parse_utils.h"
 
+#include <limits>
+
 #include "base/logging.h"
 #include "syzygy/common/buffer_parser.h"
 
@@ -128,5 +130,197 @@ bool ParseTraceFileHeaderBlob(const TraceFileHeader& header,
   return true;
 }
 
+bool IsCompactRecordType(uint16_t type) {
+  return type == TRACE_COMPACT_BATCH_ENTER ||
+         type == TRACE_COMPACT_DETAILED_FUNCTION_CALL ||
+         type == TRACE_SPARSE_INDEXED_FREQUENCY;
+}
+
+bool ExpandCompactRecord(const RecordPrefix& prefix,
+                         const uint8_t* data,
+                         uint32_t thread_id,
+                         uint16_t* type,
+                         std::vector<uint8_t>* record) {
+  DCHECK(data != NULL);
+  DCHECK(type != NULL);
+  DCHECK(record != NULL);
+
+  const uint8_t* end = data + prefix.size;
+  if (prefix.type == TRACE_COMPACT_BATCH_ENTER) {
+    if (prefix.size < sizeof(TraceCompactBatchEnterData)) {
+      LOG(ERROR) << "Short compact batch event.";
+      return false;
+    }
+    TraceCompactBatchEnterData compact = {};
+    ::memcpy(&compact, data, sizeof(compact));
+
+    // Each call takes at least two bytes, which bounds the allocation.
+    const uint8_t* calls = data + sizeof(compact);
+    if (compact.num_calls > static_cast<size_t>(end - calls) / 2) {
+      LOG(ERROR) << "Short compact batch event data.";
+      return false;
+    }
+
+    record->resize(FIELD_OFFSET(TraceBatchEnterData, calls) +
+                   compact.num_calls * sizeof(TraceEnterEventData));
+    TraceBatchEnterData* batch =
+        reinterpret_cast<TraceBatchEnterData*>(record->data());
+    batch->thread_id = thread_id;
+    batch->num_calls = compact.num_calls;
+    uintptr_t function = 0;
+    uintptr_t retaddr = 0;
+    for (size_t i = 0; i < compact.num_calls; ++i) {
+      uint64_t function_delta = 0;
+      uint64_t retaddr_delta = 0;
+      if (!DecodeVarint(&calls, end, &function_delta) ||
+          !DecodeVarint(&calls, end, &retaddr_delta)) {
+        LOG(ERROR) << "Malformed call in compact batch event.";
+        return false;
+      }
+      function += static_cast<uintptr_t>(ZigZagDecode(function_delta));
+      retaddr += static_cast<uintptr_t>(ZigZagDecode(retaddr_delta));
+      batch->calls[i].function = reinterpret_cast<FuncAddr>(function);
+      batch->calls[i].retaddr = reinterpret_cast<RetAddr>(retaddr);
+    }
+
+    *type = TRACE_BATCH_ENTER;
+    return true;
+  }
+
+  if (prefix.type == TRACE_COMPACT_DETAILED_FUNCTION_CALL) {
+    uint64_t timestamp_delta = 0;
+    uint64_t function_id = 0;
+    uint64_t stack_trace_id = 0;
+    uint64_t args_count = 0;
+    if (!DecodeVarint(&data, end, &timestamp_delta) ||
+        !DecodeVarint(&data, end, &function_id) ||
+        !DecodeVarint(&data, end, &stack_trace_id) ||
+        !DecodeVarint(&data, end, &args_count)) {
+      LOG(ERROR) << "Malformed compact detailed function call event.";
+      return false;
+    }
+
+    // Each argument size takes at least a byte, which bounds the allocation.
+    if (args_count > static_cast<size_t>(end - data)) {
+      LOG(ERROR) << "Short compact detailed function call event.";
+      return false;
+    }
+    std::vector<uint32_t> arg_sizes(static_cast<size_t>(args_count));
+    uint64_t args_data_size = 0;
+    for (size_t i = 0; i < arg_sizes.size(); ++i) {
+      uint64_t arg_size = 0;
+      if (!DecodeVarint(&data, end, &arg_size) || arg_size > prefix.size) {
+        LOG(ERROR) << "Malformed compact detailed function call event.";
+        return false;
+      }
+      arg_sizes[i] = static_cast<uint32_t>(arg_size);
+      args_data_size += arg_size;
+    }
+    if (args_data_size != static_cast<size_t>(end - data)) {
+      LOG(ERROR) << "Compact detailed function call event size mismatch.";
+      return false;
+    }
+
+    // The argument data is laid out as in TraceDetailedFunctionCall, with the
+    // count and sizes as 32-bit words.
+    size_t argument_data_size = 0;
+    if (args_data_size > 0) {
+      argument_data_size = (arg_sizes.size() + 1) * sizeof(uint32_t) +
+                           static_cast<size_t>(args_data_size);
+    }
+    record->assign(FIELD_OFFSET(TraceDetailedFunctionCall, argument_data) +
+                       argument_data_size,
+                   0);
+    TraceDetailedFunctionCall* call =
+        reinterpret_cast<TraceDetailedFunctionCall*>(record->data());
+    call->timestamp = prefix.timestamp + ZigZagDecode(timestamp_delta);
+    call->function_id = static_cast<uint32_t>(function_id);
+    call->stack_trace_id = static_cast<uint32_t>(stack_trace_id);
+    call->argument_data_size = static_cast<uint32_t>(argument_data_size);
+    if (argument_data_size > 0) {
+      uint32_t* words = reinterpret_cast<uint32_t*>(call->argument_data);
+      *words++ = static_cast<uint32_t>(arg_sizes.size());
+      for (size_t i = 0; i < arg_sizes.size(); ++i)
+        *words++ = arg_sizes[i];
+      ::memcpy(words, data, static_cast<size_t>(args_data_size));
+    }
+
+    *type = TRACE_DETAILED_FUNCTION_CALL;
+    return true;
+  }
+
+  if (prefix.type == TRACE_SPARSE_INDEXED_FREQUENCY) {
+    const size_t kHeaderSize =
+        offsetof(TraceSparseIndexedFrequencyData, runs);
+    if (prefix.size < kHeaderSize) {
+      LOG(ERROR) << "Short sparse indexed frequency event.";
+      return false;
+    }
+    TraceSparseIndexedFrequencyData sparse = {};
+    ::memcpy(&sparse, data, kHeaderSize);
+    if (sparse.frequency_size != 1 && sparse.frequency_size != 2 &&
+        sparse.frequency_size != 4) {
+      LOG(ERROR) << "Invalid frequency size in sparse indexed frequency event.";
+      return false;
+    }
+
+    // The dense record has to fit the 32-bit size of a record prefix.
+    uint64_t entry_size =
+        static_cast<uint64_t>(sparse.num_columns) * sparse.frequency_size;
+    uint64_t data_size = sparse.num_entries * entry_size;
+    if (data_size > std::numeric_limits<uint32_t>::max()) {
+      LOG(ERROR) << "Sparse indexed frequency event is too large.";
+      return false;
+    }
+
+    record->assign(offsetof(TraceIndexedFrequencyData, frequency_data) +
+                       static_cast<size_t>(data_size),
+                   0);
+    TraceIndexedFrequencyData* dense =
+        reinterpret_cast<TraceIndexedFrequencyData*>(record->data());
+    dense->module_base_addr = sparse.module_base_addr;
+    dense->module_base_size = sparse.module_base_size;
+    dense->module_checksum = sparse.module_checksum;
+    dense->module_time_date_stamp = sparse.module_time_date_stamp;
+    dense->num_entries = sparse.num_entries;
+    dense->num_columns = sparse.num_columns;
+    dense->data_type = sparse.data_type;
+    dense->frequency_size = sparse.frequency_size;
+
+    const uint8_t* runs = data + kHeaderSize;
+    uint64_t entry = 0;
+    while (runs != end) {
+      uint64_t skipped = 0;
+      uint64_t count = 0;
+      if (!DecodeVarint(&runs, end, &skipped) ||
+          !DecodeVarint(&runs, end, &count)) {
+        LOG(ERROR) << "Malformed run in sparse indexed frequency event.";
+        return false;
+      }
+      if (skipped > sparse.num_entries - entry ||
+          count > sparse.num_entries - entry - skipped) {
+        LOG(ERROR) << "Run out of range in sparse indexed frequency event.";
+        return false;
+      }
+      entry += skipped;
+      uint64_t run_size = count * entry_size;
+      if (run_size > static_cast<size_t>(end - runs)) {
+        LOG(ERROR) << "Short run in sparse indexed frequency event.";
+        return false;
+      }
+      ::memcpy(dense->frequency_data + entry * entry_size, runs,
+               static_cast<size_t>(run_size));
+      runs += run_size;
+      entry += count;
+    }
+
+    *type = TRACE_INDEXED_FREQUENCY;
+    return true;
+  }
+
+  LOG(ERROR) << "Not a compact record type: " << prefix.type << ".";
+  return false;
+}
+
 }  // namespace parser
 }  // namespace trace
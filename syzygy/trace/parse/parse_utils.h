@@ -17,6 +17,8 @@
 #ifndef SYZYGY_TRACE_PARSE_PARSE_UTILS_H_
 #define SYZYGY_TRACE_PARSE_PARSE_UTILS_H_
 
+#include <vector>
+
 #include "syzygy/trace/protocol/call_trace_defs.h"
 
 namespace trace {
@@ -39,6 +41,26 @@ bool ParseTraceFileHeaderBlob(const TraceFileHeader& header,
                               std::wstring* command_line,
                               TraceEnvironmentStrings* env_strings);
 
+// @param type the type of a record.
+// @returns true if @p type is that of one of the compact record encodings.
+bool IsCompactRecordType(uint16_t type);
+
+// Expands a record in one of the compact encodings into the record it stands
+// for, so that TraceCompactBatchEnterData is expanded to TraceBatchEnterData,
+// TraceCompactDetailedFunctionCall to TraceDetailedFunctionCall and
+// TraceSparseIndexedFrequencyData to TraceIndexedFrequencyData.
+// @param prefix the prefix of the compact record.
+// @param data the compact record, of @p prefix.size bytes.
+// @param thread_id the thread owning the segment of the record.
+// @param type receives the type of the expanded record.
+// @param record receives the expanded record.
+// @returns true on success, false if the compact record is malformed.
+bool ExpandCompactRecord(const RecordPrefix& prefix,
+                         const uint8_t* data,
+                         uint32_t thread_id,
+                         uint16_t* type,
+                         std::vector<uint8_t>* record);
+
 }  // namespace parser
 }  // namespace trace
 
@@ -134,5 +134,149 @@ TEST_F(ParseTraceFileHeaderBlobTest, SucceedsOnGoodData) {
   EXPECT_THAT(env_strings, ::testing::ContainerEq(expected_env_strings));
 }
 
+TEST(ExpandCompactRecordTest, BatchEnter) {
+  // Two calls, the second at lower addresses than the first.
+  std::vector<uint8_t> data(sizeof(TraceCompactBatchEnterData));
+  reinterpret_cast<TraceCompactBatchEnterData*>(data.data())->num_calls = 2;
+  uint8_t buffer[kMaxVarintLength] = {};
+  const int64_t kDeltas[] = { 0x1000, 0x2000, -0x10, 0x30 };
+  for (size_t i = 0; i < arraysize(kDeltas); ++i) {
+    size_t length = EncodeVarint(ZigZagEncode(kDeltas[i]), buffer);
+    data.insert(data.end(), buffer, buffer + length);
+  }
+  // A call that was being written when the thread was terminated.
+  data.push_back(0x80);
+
+  RecordPrefix prefix = {};
+  prefix.type = TRACE_COMPACT_BATCH_ENTER;
+  prefix.size = data.size();
+  EXPECT_TRUE(IsCompactRecordType(prefix.type));
+
+  uint16_t type = 0;
+  std::vector<uint8_t> record;
+  ASSERT_TRUE(ExpandCompactRecord(prefix, data.data(), 42, &type, &record));
+  EXPECT_EQ(TRACE_BATCH_ENTER, type);
+  ASSERT_EQ(FIELD_OFFSET(TraceBatchEnterData, calls) +
+                2 * sizeof(TraceEnterEventData),
+            record.size());
+  const TraceBatchEnterData* batch =
+      reinterpret_cast<const TraceBatchEnterData*>(record.data());
+  EXPECT_EQ(42u, batch->thread_id);
+  ASSERT_EQ(2u, batch->num_calls);
+  EXPECT_EQ(reinterpret_cast<FuncAddr>(0x1000), batch->calls[0].function);
+  EXPECT_EQ(reinterpret_cast<RetAddr>(0x2000), batch->calls[0].retaddr);
+  EXPECT_EQ(reinterpret_cast<FuncAddr>(0xFF0), batch->calls[1].function);
+  EXPECT_EQ(reinterpret_cast<RetAddr>(0x2030), batch->calls[1].retaddr);
+
+  // Counted calls that are missing are an error.
+  reinterpret_cast<TraceCompactBatchEnterData*>(data.data())->num_calls = 3;
+  EXPECT_FALSE(ExpandCompactRecord(prefix, data.data(), 42, &type, &record));
+}
+
+TEST(ExpandCompactRecordTest, DetailedFunctionCall) {
+  // A call with a 2-byte and a 1-byte argument.
+  const uint64_t kValues[] = { ZigZagEncode(-3), 7, 300, 2, 2, 1 };
+  std::vector<uint8_t> data;
+  uint8_t buffer[kMaxVarintLength] = {};
+  for (size_t i = 0; i < arraysize(kValues); ++i) {
+    size_t length = EncodeVarint(kValues[i], buffer);
+    data.insert(data.end(), buffer, buffer + length);
+  }
+  const uint8_t kArguments[] = { 0xAA, 0xBB, 0xCC };
+  data.insert(data.end(), kArguments, kArguments + arraysize(kArguments));
+
+  RecordPrefix prefix = {};
+  prefix.timestamp = 1000;
+  prefix.type = TRACE_COMPACT_DETAILED_FUNCTION_CALL;
+  prefix.size = data.size();
+  EXPECT_TRUE(IsCompactRecordType(prefix.type));
+
+  uint16_t type = 0;
+  std::vector<uint8_t> record;
+  ASSERT_TRUE(ExpandCompactRecord(prefix, data.data(), 42, &type, &record));
+  EXPECT_EQ(TRACE_DETAILED_FUNCTION_CALL, type);
+  const TraceDetailedFunctionCall* call =
+      reinterpret_cast<const TraceDetailedFunctionCall*>(record.data());
+  EXPECT_EQ(997u, call->timestamp);
+  EXPECT_EQ(7u, call->function_id);
+  EXPECT_EQ(300u, call->stack_trace_id);
+
+  const uint8_t kExpectedArgumentData[] = {
+      0x02, 0x00, 0x00, 0x00,  // 2 arguments...
+      0x02, 0x00, 0x00, 0x00,  // ...of size 2...
+      0x01, 0x00, 0x00, 0x00,  // ...and 1.
+      0xAA, 0xBB, 0xCC,
+  };
+  ASSERT_EQ(arraysize(kExpectedArgumentData), call->argument_data_size);
+  ASSERT_EQ(FIELD_OFFSET(TraceDetailedFunctionCall, argument_data) +
+                call->argument_data_size,
+            record.size());
+  EXPECT_EQ(0, ::memcmp(kExpectedArgumentData, call->argument_data,
+                        call->argument_data_size));
+
+  // Argument data that doesn't match the sizes is an error.
+  prefix.size -= 1;
+  EXPECT_FALSE(ExpandCompactRecord(prefix, data.data(), 42, &type, &record));
+
+  EXPECT_FALSE(IsCompactRecordType(TRACE_DETAILED_FUNCTION_CALL));
+}
+
+TEST(ExpandCompactRecordTest, SparseIndexedFrequency) {
+  const size_t kHeaderSize = offsetof(TraceSparseIndexedFrequencyData, runs);
+  std::vector<uint8_t> data(kHeaderSize);
+  TraceSparseIndexedFrequencyData* sparse =
+      reinterpret_cast<TraceSparseIndexedFrequencyData*>(data.data());
+  sparse->module_base_addr = reinterpret_cast<ModuleAddr>(0x10000000);
+  sparse->module_base_size = 0x1000;
+  sparse->module_checksum = 0xCAFE;
+  sparse->module_time_date_stamp = 0xBABE;
+  sparse->num_entries = 10;
+  sparse->num_columns = 1;
+  sparse->data_type = 1;
+  sparse->frequency_size = 1;
+
+  // Two runs, of entries 2 and 3, then of entry 7.
+  const uint8_t kRuns[] = { 2, 2, 5, 6, 3, 1, 9 };
+  data.insert(data.end(), kRuns, kRuns + arraysize(kRuns));
+
+  RecordPrefix prefix = {};
+  prefix.type = TRACE_SPARSE_INDEXED_FREQUENCY;
+  prefix.size = data.size();
+  EXPECT_TRUE(IsCompactRecordType(prefix.type));
+
+  uint16_t type = 0;
+  std::vector<uint8_t> record;
+  ASSERT_TRUE(ExpandCompactRecord(prefix, data.data(), 42, &type, &record));
+  EXPECT_EQ(TRACE_INDEXED_FREQUENCY, type);
+  ASSERT_EQ(offsetof(TraceIndexedFrequencyData, frequency_data) + 10,
+            record.size());
+  const TraceIndexedFrequencyData* dense =
+      reinterpret_cast<const TraceIndexedFrequencyData*>(record.data());
+  EXPECT_EQ(reinterpret_cast<ModuleAddr>(0x10000000),
+            dense->module_base_addr);
+  EXPECT_EQ(0x1000u, dense->module_base_size);
+  EXPECT_EQ(0xCAFEu, dense->module_checksum);
+  EXPECT_EQ(0xBABEu, dense->module_time_date_stamp);
+  EXPECT_EQ(10u, dense->num_entries);
+  EXPECT_EQ(1u, dense->num_columns);
+  EXPECT_EQ(1u, dense->data_type);
+  EXPECT_EQ(1u, dense->frequency_size);
+  const uint8_t kExpectedFrequencies[] = { 0, 0, 5, 6, 0, 0, 0, 9, 0, 0 };
+  EXPECT_EQ(0, ::memcmp(kExpectedFrequencies, dense->frequency_data,
+                        arraysize(kExpectedFrequencies)));
+
+  // A truncated run is an error.
+  prefix.size -= 1;
+  EXPECT_FALSE(ExpandCompactRecord(prefix, data.data(), 42, &type, &record));
+
+  // So is a run past the last entry.
+  prefix.size += 1;
+  sparse = reinterpret_cast<TraceSparseIndexedFrequencyData*>(data.data());
+  sparse->num_entries = 7;
+  EXPECT_FALSE(ExpandCompactRecord(prefix, data.data(), 42, &type, &record));
+
+  EXPECT_FALSE(IsCompactRecordType(TRACE_INDEXED_FREQUENCY));
+}
+
 }  // namespace parser
 }  // namespace trace
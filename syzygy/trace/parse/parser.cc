@@ -16,6 +16,8 @@
 
 #include "syzygy/trace/parse/parser.h"
 
+#include <limits>
+
 #include "base/logging.h"
 #include "syzygy/common/buffer_parser.h"
 #include "syzygy/trace/parse/parse_engine_rpc.h"
@@ -25,6 +27,52 @@ namespace parser {
 
 using ::common::BinaryBufferParser;
 
+namespace {
+
+// The segments holding these records are always parsed, as the events of the
+// other segments may depend on them.
+const uint64_t kStateRecordTypes =
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_PROCESS_ATTACH_EVENT) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_PROCESS_DETACH_EVENT) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_THREAD_ATTACH_EVENT) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_THREAD_DETACH_EVENT) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_MODULE_EVENT) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_PROCESS_ENDED) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_THREAD_NAME) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_DYNAMIC_SYMBOL) |
+    TraceFileSegmentIndexEntry::GetRecordTypeBit(
+        TRACE_FUNCTION_NAME_TABLE_ENTRY);
+
+}  // namespace
+
+SegmentFilter::SegmentFilter()
+    : min_timestamp(0),
+      max_timestamp(std::numeric_limits<uint64_t>::max()),
+      record_types(std::numeric_limits<uint64_t>::max()) {
+}
+
+bool SegmentFilter::IsEmpty() const {
+  return min_timestamp == 0 &&
+         max_timestamp == std::numeric_limits<uint64_t>::max() &&
+         thread_ids.empty() &&
+         record_types == std::numeric_limits<uint64_t>::max();
+}
+
+bool SegmentFilter::Matches(const TraceFileSegmentIndexEntry& entry) const {
+  if ((entry.record_types & kStateRecordTypes) != 0)
+    return true;
+
+  if (entry.last_timestamp < min_timestamp ||
+      entry.first_timestamp > max_timestamp) {
+    return false;
+  }
+  if (!thread_ids.empty() &&
+      thread_ids.find(entry.thread_id) == thread_ids.end()) {
+    return false;
+  }
+  return (entry.record_types & record_types) != 0;
+}
+
 Parser::Parser() : active_parse_engine_(NULL) {
 }
 
@@ -88,6 +136,14 @@ bool Parser::OpenTraceFile(const base::FilePath& trace_file_path) {
   return active_parse_engine_->OpenTraceFile(trace_file_path);
 }
 
+void Parser::set_segment_filter(const SegmentFilter& filter) {
+  DCHECK(!parse_engine_set_.empty());
+
+  ParseEngineIter it = parse_engine_set_.begin();
+  for (; it != parse_engine_set_.end(); ++it)
+    (*it)->set_segment_filter(filter);
+}
+
 bool Parser::Consume() {
   if (active_parse_engine_ == NULL) {
     LOG(ERROR) << "No open trace files to consume.";
@@ -252,5 +308,11 @@ void ParseEventHandlerImpl::OnProcessHeap(base::Time time,
                                           const TraceProcessHeap* data) {
 }
 
+void ParseEventHandlerImpl::OnHeapAllocationSnapshot(
+    base::Time time,
+    DWORD process_id,
+    const TraceHeapAllocationSnapshot* data) {
+}
+
 }  // namespace parser
 }  // namespace trace
@@ -18,6 +18,7 @@
 #define SYZYGY_TRACE_PARSE_PARSER_H_
 
 #include <list>
+#include <set>
 
 #include "base/files/file_path.h"
 #include "base/strings/string_piece.h"
@@ -56,6 +57,36 @@ typedef core::AddressSpace<AbsoluteAddress64,
 class ParseEngine;
 class ParseEventHandler;
 
+// Restricts the segments of trace files with a segment index that are
+// parsed, by looking up their index entries. This is coarse: the segments in
+// which a record may match are parsed in full, and trace files without an
+// index are parsed in full. The segments that may hold process, thread or
+// module events, thread names or symbols are always parsed, so that the
+// events of the others resolve as they would had the whole file been parsed.
+struct SegmentFilter {
+  SegmentFilter();
+
+  // @returns true if no segments are filtered out.
+  bool IsEmpty() const;
+
+  // @param entry the index entry of a segment.
+  // @returns true if the segment is to be parsed.
+  bool Matches(const TraceFileSegmentIndexEntry& entry) const;
+
+  // The range of record timestamps of interest, inclusive. These are
+  // timestamps as found in the RecordPrefix of records.
+  uint64_t min_timestamp;
+  uint64_t max_timestamp;
+
+  // The threads of interest, or all threads if empty.
+  std::set<uint32_t> thread_ids;
+
+  // The record types of interest, as a set of the bits returned by
+  // TraceFileSegmentIndexEntry::GetRecordTypeBit.
+  uint64_t record_types;
+};
+
+
 // A facade class that manages the various call trace parser engines which
 // Syzygy supports and presents a single interface that selects the most
 // appropriate one based on the files being parsed.
@@ -88,6 +119,11 @@ class Parser {
   // open trace files of different type in a single parse session.
   bool OpenTraceFile(const base::FilePath& trace_file_path);
 
+  // Restricts the segments parsed, in trace files with a segment index. This
+  // must be called after Init and before Consume.
+  // @param filter the filter of the segments to parse.
+  void set_segment_filter(const SegmentFilter& filter);
+
   // Consume all events across all currently open trace files.
   bool Consume();
 
@@ -234,6 +270,12 @@ class ParseEventHandler {
   virtual void OnProcessHeap(base::Time time,
                              DWORD process_id,
                              const TraceProcessHeap* data) = 0;
+
+  // Issued for heap allocation snapshot records.
+  virtual void OnHeapAllocationSnapshot(
+      base::Time time,
+      DWORD process_id,
+      const TraceHeapAllocationSnapshot* data) = 0;
 };
 
 // A default implementation of the ParseEventHandler interface. Provides
@@ -311,6 +353,10 @@ class ParseEventHandlerImpl : public ParseEventHandler {
   void OnProcessHeap(base::Time time,
                      DWORD process_id,
                      const TraceProcessHeap* data) override;
+  void OnHeapAllocationSnapshot(
+      base::Time time,
+      DWORD process_id,
+      const TraceHeapAllocationSnapshot* data) override;
   // @}
 };
 
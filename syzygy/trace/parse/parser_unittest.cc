@@ -23,5 +23,47 @@ TEST(ParserUnittest, ParseEventHandlerImplIsConcrete) {
   ParseEventHandlerImpl impl;
 }
 
+TEST(ParserUnittest, SegmentFilter) {
+  SegmentFilter filter;
+  EXPECT_TRUE(filter.IsEmpty());
+
+  TraceFileSegmentIndexEntry entry = {};
+  entry.first_timestamp = 100;
+  entry.last_timestamp = 200;
+  entry.thread_id = 7;
+  entry.record_types =
+      TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_ENTER_EVENT);
+  EXPECT_TRUE(filter.Matches(entry));
+
+  // Segments outside of the time range are filtered out.
+  filter.min_timestamp = 201;
+  EXPECT_FALSE(filter.IsEmpty());
+  EXPECT_FALSE(filter.Matches(entry));
+  filter.min_timestamp = 150;
+  filter.max_timestamp = 99;
+  EXPECT_FALSE(filter.Matches(entry));
+  filter.max_timestamp = 150;
+  EXPECT_TRUE(filter.Matches(entry));
+
+  // As are the segments of other threads.
+  filter.thread_ids.insert(8);
+  EXPECT_FALSE(filter.Matches(entry));
+  filter.thread_ids.insert(7);
+  EXPECT_TRUE(filter.Matches(entry));
+
+  // And the segments without records of interest.
+  filter.record_types =
+      TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_EXIT_EVENT);
+  EXPECT_FALSE(filter.Matches(entry));
+
+  // Segments holding module events are always parsed.
+  entry.record_types |=
+      TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_MODULE_EVENT);
+  entry.thread_id = 9;
+  entry.first_timestamp = 0;
+  entry.last_timestamp = 1;
+  EXPECT_TRUE(filter.Matches(entry));
+}
+
 }  // namespace parser
 }  // namespace trace
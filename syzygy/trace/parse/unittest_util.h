@@ -99,6 +99,10 @@ class MockParseEventHandler : public trace::parser::ParseEventHandler {
                void(base::Time time,
                     DWORD process_id,
                     const TraceProcessHeap* data));
+  MOCK_METHOD3(OnHeapAllocationSnapshot,
+               void(base::Time time,
+                    DWORD process_id,
+                    const TraceHeapAllocationSnapshot* data));
 };
 
 typedef testing::StrictMock<MockParseEventHandler> StrictMockParseEventHandler;
@@ -80,6 +80,9 @@ void MakeInstanceString(const base::StringPiece16& prefix,
 const TraceFileHeader::Signature TraceFileHeader::kSignatureValue = {
     'S', 'Z', 'G', 'Y' };
 
+const TraceFileSegmentIndexTrailer::Signature
+    TraceFileSegmentIndexTrailer::kSignatureValue = { 'S', 'Z', 'I', 'X' };
+
 void GetSyzygyCallTraceRpcProtocol(std::wstring* protocol) {
   DCHECK(protocol != NULL);
   protocol->assign(kCallTraceRpcProtocol);
@@ -66,12 +66,16 @@ extern const char kSyzygyRpcSessionMandatoryEnvVar[];
 // This must be bumped anytime the file format is changed.
 enum {
   TRACE_VERSION_HI = 1,
-  TRACE_VERSION_LO = 4,
+  TRACE_VERSION_LO = 5,
 };
 
 enum TraceEventType {
   // Header prefix for a "page" of call trace events.
   TRACE_PAGE_HEADER,
+  // Header prefix for a compressed "page" of call trace events.
+  TRACE_COMPRESSED_PAGE_HEADER,
+  // The index of the segments of a trace file.
+  TRACE_SEGMENT_INDEX,
   // The actual events are below.
   TRACE_PROCESS_STARTED = 10,
   TRACE_PROCESS_ENDED,
@@ -93,6 +97,10 @@ enum TraceEventType {
   TRACE_DETAILED_FUNCTION_CALL,
   TRACE_COMMENT,
   TRACE_PROCESS_HEAP,
+  TRACE_COMPACT_BATCH_ENTER,
+  TRACE_COMPACT_DETAILED_FUNCTION_CALL,
+  TRACE_HEAP_ALLOCATION_SNAPSHOT,
+  TRACE_SPARSE_INDEXED_FREQUENCY,
 };
 
 // All traces are emitted at this trace level.
@@ -111,6 +119,14 @@ enum TraceEventFlags {
   TRACE_FLAG_THREAD_EVENTS  = 0x0010,
   // Batch entry traces.
   TRACE_FLAG_BATCH_ENTER    = 0x0020,
+  // Emit the compact encodings of the high-rate records, where the agent
+  // has one. This may be combined with TRACE_FLAG_BATCH_ENTER.
+  TRACE_FLAG_COMPACT_RECORDS = 0x0040,
+  // Drop the entries into the function that was last entered on the same
+  // thread, such as those of direct recursion or of calls in a loop. This
+  // keeps the order in which functions are first called. This may be
+  // combined with TRACE_FLAG_BATCH_ENTER.
+  TRACE_FLAG_FILTER_REPEATED_ENTRIES = 0x0080,
 };
 
 // Max depth of stack trace captured on entry/exit.
@@ -163,6 +179,14 @@ struct TraceFileHeader {
   // A canonical value for the signature.
   static const Signature kSignatureValue;
 
+  // The flags of a trace file.
+  enum Flags {
+    // Segments may be TraceFileCompressedSegmentHeader segments.
+    kCompressedSegments = 1 << 0,
+    // The segments may be followed by a TraceFileSegmentIndex record.
+    kSegmentIndex = 1 << 1,
+  };
+
   // A signature is at the start of the trace file header.
   Signature signature;
 
@@ -211,6 +235,9 @@ struct TraceFileHeader {
   // header itself.
   trace::common::ClockInfo clock_info;
 
+  // Bits from the Flags enumeration above.
+  uint32_t flags;
+
   // The header is required to store multiple variable length fields. We do
   // this via a blob mechanism. The header contains a single binary blob at the
   // end, whose length in bytes) is encoded via blob_length.
@@ -251,6 +278,99 @@ struct TraceFileSegmentHeader {
 };
 COMPILE_ASSERT_IS_POD(TraceFileSegmentHeader);
 
+// May be written in place of a TraceFileSegmentHeader in trace files whose
+// header has the kCompressedSegments flag. The records of the segment are
+// then zlib-compressed, and the compressed length rounded up to the
+// block_size is what's on disk.
+struct TraceFileCompressedSegmentHeader {
+  // Type identifiers used for these headers.
+  enum { kTypeId = TRACE_COMPRESSED_PAGE_HEADER };
+
+  // The identity of the thread that is reporting in this segment
+  // of the trace file.
+  uint32_t thread_id;
+
+  // The number of compressed data bytes in this segment of the trace file.
+  // This value does not include the size of the record prefix nor the size
+  // of the segment header.
+  uint32_t segment_length;
+
+  // The number of data bytes once decompressed.
+  uint32_t uncompressed_length;
+
+  // The summary of the records of the segment, for the segment index, as
+  // they can't be read without decompressing them. See
+  // TraceFileSegmentIndexEntry.
+  uint64_t first_timestamp;
+  uint64_t last_timestamp;
+  uint64_t record_types;
+};
+COMPILE_ASSERT_IS_POD(TraceFileCompressedSegmentHeader);
+
+// Summarizes a segment of a trace file in its segment index.
+struct TraceFileSegmentIndexEntry {
+  // @returns the bit of record_types standing for records of @p type.
+  static uint64_t GetRecordTypeBit(uint16_t type) {
+    return static_cast<uint64_t>(1) << (type % 64);
+  }
+
+  // The offset of the segment's record prefix in the trace file.
+  uint64_t offset;
+
+  // The earliest and latest timestamps of the records of the segment.
+  uint64_t first_timestamp;
+  uint64_t last_timestamp;
+
+  // The record types found in the segment, as a set of the bits returned by
+  // GetRecordTypeBit. A clear bit means there are no records of the types
+  // standing for it.
+  uint64_t record_types;
+
+  // The identity of the thread that reported the segment.
+  uint32_t thread_id;
+
+  // Reserved for future use, and zero.
+  uint32_t reserved;
+};
+COMPILE_ASSERT_IS_POD(TraceFileSegmentIndexEntry);
+
+// Written after the last segment of trace files whose header has the
+// kSegmentIndex flag, so that segments may be looked up without reading the
+// whole trace file. The record is padded to the block size, and the trailer
+// locating it takes up the end of its last block, which is the end of the
+// trace file. The size in its record prefix covers the padding and trailer.
+struct TraceFileSegmentIndex {
+  // Type identifiers used for these records.
+  enum { kTypeId = TRACE_SEGMENT_INDEX };
+
+  // The number of entries, in the order of the segments in the trace file.
+  uint32_t num_entries;
+
+  // Reserved for future use, and zero.
+  uint32_t reserved;
+
+  TraceFileSegmentIndexEntry entries[1];
+};
+COMPILE_ASSERT_IS_POD(TraceFileSegmentIndex);
+
+// Ends the last block of a trace file with a segment index.
+struct TraceFileSegmentIndexTrailer {
+  // In a valid trailer, this is "SZIX".
+  typedef char Signature[4];
+
+  // A canonical value for the signature.
+  static const Signature kSignatureValue;
+
+  Signature signature;
+
+  // Reserved for future use, and zero.
+  uint32_t reserved;
+
+  // The offset of the record prefix of the segment index in the trace file.
+  uint64_t index_offset;
+};
+COMPILE_ASSERT_IS_POD(TraceFileSegmentIndexTrailer);
+
 // The structure traced on function entry or exit.
 template<int TypeId>
 struct TraceEnterExitEventDataTempl {
@@ -499,6 +619,123 @@ struct TraceDetailedFunctionCall {
 };
 COMPILE_ASSERT_IS_POD(TraceDetailedFunctionCall);
 
+// @name Helpers for the compact record encodings. These store unsigned
+// integers as little-endian base-128 varints, and signed integers zigzag
+// encoded so that small magnitudes encode to short varints.
+// @{
+// The maximum length of an encoded 64-bit varint.
+const size_t kMaxVarintLength = 10;
+
+// Encodes @p value at @p buffer, which must have room for kMaxVarintLength
+// bytes.
+// @returns the number of bytes written.
+inline size_t EncodeVarint(uint64_t value, uint8_t* buffer) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    buffer[length++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  buffer[length++] = static_cast<uint8_t>(value);
+  return length;
+}
+
+// Decodes a varint from [*data, end), advancing @p data past it.
+// @returns false if the varint is truncated or overlong.
+inline bool DecodeVarint(const uint8_t** data,
+                         const uint8_t* end,
+                         uint64_t* value) {
+  uint64_t result = 0;
+  for (size_t shift = 0; shift < 7 * kMaxVarintLength; shift += 7) {
+    if (*data == end)
+      return false;
+    uint8_t byte = *(*data)++;
+    result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+// @}
+
+// The compact encoding of a TraceBatchEnterData, emitted in its place by the
+// agents that were handed TRACE_FLAG_COMPACT_RECORDS. The calls come from the
+// thread owning the segment. Each call is encoded as two zigzag varints: the
+// difference between its function address and that of the previous call of
+// the record, then the same for its return address. The first call of the
+// record is relative to zero. Consecutive calls tend to be to nearby
+// functions of the same module, so this takes 2 to 6 bytes rather than 8.
+struct TraceCompactBatchEnterData {
+  enum { kTypeId = TRACE_COMPACT_BATCH_ENTER };
+
+  // The number of calls, which are encoded after this header up to the end
+  // of the record. The calls are written before this is bumped, so a thread
+  // terminated mid-write leaves at most a partial call past the last counted
+  // one, which is ignored.
+  uint32_t num_calls;
+};
+COMPILE_ASSERT_IS_POD(TraceCompactBatchEnterData);
+
+// The compact encoding of a TraceDetailedFunctionCall, emitted in its place
+// by the agents that were handed TRACE_FLAG_COMPACT_RECORDS. The record is a
+// sequence of varints:
+// - the timestamp of the call, zigzag encoded relative to the timestamp of
+//   the record prefix. Agents reading the TSC make these equal, so this takes
+//   a byte.
+// - the function ID.
+// - the stack trace ID.
+// - the number of arguments, followed by the size of each of them.
+// These are followed by the argument data, to the end of the record, laid
+// out as in TraceDetailedFunctionCall.
+struct TraceCompactDetailedFunctionCall {
+  enum { kTypeId = TRACE_COMPACT_DETAILED_FUNCTION_CALL };
+
+  uint8_t data[1];
+};
+COMPILE_ASSERT_IS_POD(TraceCompactDetailedFunctionCall);
+
+// The sparse encoding of a TraceIndexedFrequencyData, written in its place by
+// the call trace service when it is smaller. The agents increment their
+// frequencies in place, so they always emit the dense record. The header is
+// that of the dense record. It is followed by a sequence of runs, up to the
+// end of the record, each of which is:
+// - a varint, the number of entries skipped since the end of the previous
+//   run, or the start of the frequencies. These are all zero.
+// - a varint, the number of entries of the run.
+// - the frequencies of the entries of the run, laid out as in
+//   TraceIndexedFrequencyData.
+// The entries past the last run are all zero. For a large module of which
+// only a few basic blocks ran, this is a small fraction of the dense record.
+struct TraceSparseIndexedFrequencyData {
+  enum { kTypeId = TRACE_SPARSE_INDEXED_FREQUENCY };
+
+  // @name These are those of the TraceIndexedFrequencyData.
+  // @{
+  ModuleAddr module_base_addr;
+  size_t module_base_size;
+  uint32_t module_checksum;
+  uint32_t module_time_date_stamp;
+  uint32_t num_entries;
+  uint32_t num_columns;
+  uint8_t data_type;
+  uint8_t frequency_size;
+  // @}
+
+  // In fact, the runs extend to the end of the record.
+  uint8_t runs[1];
+};
+COMPILE_ASSERT_IS_POD(TraceSparseIndexedFrequencyData);
+
 // Records a comment in a trace file. These are output via the call-trace
 // service and act as delimiters in a call-trace log.
 struct TraceComment {
@@ -519,4 +756,47 @@ struct TraceProcessHeap {
 };
 COMPILE_ASSERT_IS_POD(TraceProcessHeap);
 
+// The heap allocation statistics of a call site, for a class of allocation
+// sizes. The counts are cumulative since the start of the process, so rates
+// are derived from the difference between two snapshots.
+struct TraceHeapAllocationStats {
+  // The ID of the stack trace of the allocations, which is emitted as a
+  // TraceStackTrace record.
+  uint32_t stack_trace_id;
+
+  // The size class of the allocations. Class 0 holds the empty allocations,
+  // and class N > 0 those of sizes in [2^(N-1), 2^N).
+  uint32_t size_class;
+
+  // The allocations that are still live, and their total size.
+  uint32_t live_count;
+  uint32_t live_bytes;
+
+  // The number of allocations and frees made so far.
+  uint32_t alloc_count;
+  uint32_t free_count;
+
+  // The total size of the allocations made so far.
+  uint64_t alloc_bytes;
+};
+COMPILE_ASSERT_IS_POD(TraceHeapAllocationStats);
+
+// A periodic snapshot of the heap allocation statistics of a process, as
+// aggregated in-process by the memory profiler. Only the statistics that
+// changed since the previous snapshot are present. A snapshot that doesn't
+// fit a single record spans several records with the same ID.
+struct TraceHeapAllocationSnapshot {
+  enum { kTypeId = TRACE_HEAP_ALLOCATION_SNAPSHOT };
+
+  // The ID of the snapshot, counting from 0.
+  uint32_t snapshot_id;
+
+  // The number of statistics in this record.
+  uint32_t num_stats;
+
+  // There are actually |num_stats| statistics.
+  TraceHeapAllocationStats stats[1];
+};
+COMPILE_ASSERT_IS_POD(TraceHeapAllocationSnapshot);
+
 #endif  // SYZYGY_TRACE_PROTOCOL_CALL_TRACE_DEFS_H_
@@ -14,6 +14,9 @@
 
 #include "syzygy/trace/protocol/call_trace_defs.h"
 
+#include <limits>
+
+#include "base/macros.h"
 #include "gtest/gtest.h"
 
 namespace trace {
@@ -46,4 +49,39 @@ TEST(CallTraceDefsTest, GetSyzygyCallTraceRpcMutexName) {
   EXPECT_EQ(base_mutex_name + L"-bar", new_mutex_name);
 }
 
+TEST(CallTraceDefsTest, Varints) {
+  const uint64_t kValues[] = {
+      0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0xFFFFFFFF,
+      std::numeric_limits<uint64_t>::max() };
+  const size_t kLengths[] = { 1, 1, 1, 2, 2, 3, 5, kMaxVarintLength };
+  for (size_t i = 0; i < arraysize(kValues); ++i) {
+    uint8_t buffer[kMaxVarintLength] = {};
+    size_t length = EncodeVarint(kValues[i], buffer);
+    EXPECT_EQ(kLengths[i], length);
+
+    const uint8_t* data = buffer;
+    uint64_t value = 0;
+    EXPECT_TRUE(DecodeVarint(&data, buffer + length, &value));
+    EXPECT_EQ(kValues[i], value);
+    EXPECT_EQ(buffer + length, data);
+
+    // Truncated varints don't decode.
+    data = buffer;
+    EXPECT_FALSE(DecodeVarint(&data, buffer + length - 1, &value));
+  }
+}
+
+TEST(CallTraceDefsTest, ZigZag) {
+  EXPECT_EQ(0u, ZigZagEncode(0));
+  EXPECT_EQ(1u, ZigZagEncode(-1));
+  EXPECT_EQ(2u, ZigZagEncode(1));
+  EXPECT_EQ(3u, ZigZagEncode(-2));
+
+  const int64_t kValues[] = {
+      0, 1, -1, 1000, -1000, std::numeric_limits<int64_t>::max(),
+      std::numeric_limits<int64_t>::min() };
+  for (size_t i = 0; i < arraysize(kValues); ++i)
+    EXPECT_EQ(kValues[i], ZigZagDecode(ZigZagEncode(kValues[i])));
+}
+
 }  // namespace trace
@@ -0,0 +1,231 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/aggregating_trace_file_writer.h"
+
+#include <utility>
+
+#include "base/logging.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+
+namespace trace {
+namespace service {
+
+AggregatingTraceFileWriter::AggregatingTraceFileWriter(
+    base::MessageLoop* message_loop, const base::FilePath& trace_directory)
+    : SessionTraceFileWriter(message_loop, trace_directory),
+      sparse_indexed_frequencies_(false) {
+}
+
+AggregatingTraceFileWriter::AggregatingTraceFileWriter(
+    TraceFileWriterPool* writer_pool, const base::FilePath& trace_directory)
+    : SessionTraceFileWriter(writer_pool, trace_directory),
+      sparse_indexed_frequencies_(false) {
+}
+
+AggregatingTraceFileWriter::~AggregatingTraceFileWriter() {
+}
+
+void AggregatingTraceFileWriter::AddAggregator(
+    std::unique_ptr<RecordAggregator> aggregator) {
+  DCHECK(aggregator.get() != NULL);
+  base::AutoLock lock(aggregator_lock_);
+  aggregators_.push_back(std::move(aggregator));
+}
+
+bool AggregatingTraceFileWriter::Close(Session* session) {
+  // There are no more buffers to process, so the aggregates are final. They
+  // are followed by the process detach events that were held back.
+  AggregateWriter aggregate(writer_.block_size());
+  aggregate.set_sparse_indexed_frequencies(sparse_indexed_frequencies_);
+  {
+    base::AutoLock lock(aggregator_lock_);
+    for (const auto& aggregator : aggregators_)
+      aggregator->WriteAggregate(&aggregate);
+    for (const DeferredRecord& record : deferred_records_) {
+      aggregate.AppendRecord(record.thread_id, record.prefix.timestamp,
+                             record.prefix.type, record.data.data(),
+                             record.data.size());
+    }
+    deferred_records_.clear();
+  }
+
+  bool success = true;
+  for (std::vector<uint8_t>& segment : aggregate.segments()) {
+    base::AutoLock lock(lock_);
+    if (writer_.compress_segments())
+      writer_.CompressRecord(segment.data(), segment.size());
+    if (!writer_.WriteRecord(segment.data(), segment.size())) {
+      LOG(ERROR) << "Failed to write aggregated records to '"
+                 << writer_.path().value() << "'.";
+      success = false;
+    }
+  }
+
+  return SessionTraceFileWriter::Close(session) && success;
+}
+
+void AggregatingTraceFileWriter::ProcessBuffer(void* data, size_t length) {
+  DCHECK(data != NULL);
+
+  // Buffers that aren't valid segments are left for the trace file writer to
+  // drop.
+  const size_t kHeaderLength =
+      sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+  if (length < kHeaderLength)
+    return;
+  const RecordPrefix* segment_prefix = reinterpret_cast<RecordPrefix*>(data);
+  if (segment_prefix->type != TraceFileSegmentHeader::kTypeId ||
+      segment_prefix->size != sizeof(TraceFileSegmentHeader)) {
+    return;
+  }
+  TraceFileSegmentHeader* header =
+      reinterpret_cast<TraceFileSegmentHeader*>(
+          reinterpret_cast<uint8_t*>(data) + sizeof(RecordPrefix));
+  size_t segment_length = header->segment_length;
+  if (segment_length > length - kHeaderLength)
+    return;
+  uint32_t thread_id = header->thread_id;
+
+  // Compact the records that aren't absorbed in place.
+  uint8_t* records = reinterpret_cast<uint8_t*>(header + 1);
+  size_t read_offset = 0;
+  size_t write_offset = 0;
+  std::vector<uint8_t> sparse;
+  base::AutoLock lock(aggregator_lock_);
+  while (segment_length - read_offset >= sizeof(RecordPrefix)) {
+    RecordPrefix prefix = {};
+    ::memcpy(&prefix, records + read_offset, sizeof(prefix));
+    if (prefix.size > segment_length - read_offset - sizeof(RecordPrefix))
+      break;
+
+    size_t record_length = sizeof(RecordPrefix) + prefix.size;
+    const uint8_t* record_data = records + read_offset + sizeof(prefix);
+    if (AggregateRecordUnlocked(thread_id, prefix, record_data)) {
+      read_offset += record_length;
+      continue;
+    }
+
+    // The sparse encoding is smaller than the record, so it fits in its
+    // place.
+    if (sparse_indexed_frequencies_ &&
+        prefix.type == TRACE_INDEXED_FREQUENCY &&
+        EncodeSparseIndexedFrequencyData(record_data, prefix.size, &sparse)) {
+      prefix.type = TRACE_SPARSE_INDEXED_FREQUENCY;
+      prefix.size = static_cast<uint32_t>(sparse.size());
+      ::memcpy(records + write_offset, &prefix, sizeof(prefix));
+      ::memcpy(records + write_offset + sizeof(prefix), sparse.data(),
+               sparse.size());
+      write_offset += sizeof(prefix) + sparse.size();
+    } else {
+      if (write_offset != read_offset) {
+        ::memmove(records + write_offset, records + read_offset,
+                  record_length);
+      }
+      write_offset += record_length;
+    }
+    read_offset += record_length;
+  }
+
+  // Whatever couldn't be parsed is kept as is, for the parser to complain
+  // about.
+  if (read_offset < segment_length) {
+    ::memmove(records + write_offset, records + read_offset,
+              segment_length - read_offset);
+    write_offset += segment_length - read_offset;
+  }
+
+  header->segment_length = static_cast<uint32_t>(write_offset);
+}
+
+bool AggregatingTraceFileWriter::AggregateRecordUnlocked(
+    uint32_t thread_id, const RecordPrefix& prefix, const void* data) {
+  aggregator_lock_.AssertAcquired();
+
+  for (const auto& aggregator : aggregators_) {
+    if (aggregator->AggregateRecord(thread_id, prefix, data))
+      return true;
+  }
+
+  // The parser forgets about a module on its process detach event, so these
+  // have to come after the aggregates referring to the module.
+  if (!aggregators_.empty() && prefix.type == TRACE_PROCESS_DETACH_EVENT) {
+    deferred_records_.push_back(DeferredRecord());
+    DeferredRecord& record = deferred_records_.back();
+    record.thread_id = thread_id;
+    record.prefix = prefix;
+    const uint8_t* begin = reinterpret_cast<const uint8_t*>(data);
+    record.data.assign(begin, begin + prefix.size);
+    return true;
+  }
+
+  return false;
+}
+
+AggregatingTraceFileWriterFactory::AggregatingTraceFileWriterFactory(
+    base::MessageLoop* message_loop)
+    : SessionTraceFileWriterFactory(message_loop),
+      aggregate_indexed_frequencies_(false),
+      aggregate_invocations_(false),
+      sparse_indexed_frequencies_(false) {
+}
+
+AggregatingTraceFileWriterFactory::AggregatingTraceFileWriterFactory(
+    TraceFileWriterPool* writer_pool)
+    : SessionTraceFileWriterFactory(writer_pool),
+      aggregate_indexed_frequencies_(false),
+      aggregate_invocations_(false),
+      sparse_indexed_frequencies_(false) {
+}
+
+bool AggregatingTraceFileWriterFactory::CreateConsumer(
+    scoped_refptr<BufferConsumer>* consumer) {
+  DCHECK(consumer != NULL);
+
+  scoped_refptr<AggregatingTraceFileWriter> writer;
+  if (writer_pool_ != NULL) {
+    writer = new AggregatingTraceFileWriter(writer_pool_,
+                                            trace_file_directory_);
+  } else {
+    DCHECK(message_loop_ != NULL);
+    writer = new AggregatingTraceFileWriter(message_loop_,
+                                            trace_file_directory_);
+  }
+  writer->set_compress_segments(compress_segments_);
+  writer->set_index_segments(index_segments_);
+  if (!stream_pipe_name_.empty())
+    writer->set_stream_pipe_name(stream_pipe_name_);
+  writer->set_sparse_indexed_frequencies(sparse_indexed_frequencies_);
+
+  // The module filter comes first, so that records of the other modules
+  // aren't aggregated.
+  if (!module_filter_.empty()) {
+    writer->AddAggregator(std::unique_ptr<RecordAggregator>(
+        new ModuleFilter(module_filter_)));
+  }
+  if (aggregate_indexed_frequencies_) {
+    writer->AddAggregator(std::unique_ptr<RecordAggregator>(
+        new IndexedFrequencyAggregator()));
+  }
+  if (aggregate_invocations_) {
+    writer->AddAggregator(std::unique_ptr<RecordAggregator>(
+        new InvocationBatchAggregator()));
+  }
+
+  *consumer = writer;
+  return true;
+}
+
+}  // namespace service
+}  // namespace trace
@@ -0,0 +1,161 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file declares the AggregatingTraceFileWriter class, a buffer consumer
+// that runs the records of a session through a chain of RecordAggregators
+// before writing them, and its factory.
+//
+// The records an aggregator absorbs are dropped from the buffers as they're
+// written, and the aggregates are written to the end of the trace file as the
+// session closes. The process detach events are held back until then, so that
+// the parser still knows the modules the aggregates refer to.
+
+#ifndef SYZYGY_TRACE_SERVICE_AGGREGATING_TRACE_FILE_WRITER_H_
+#define SYZYGY_TRACE_SERVICE_AGGREGATING_TRACE_FILE_WRITER_H_
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/synchronization/lock.h"
+#include "syzygy/trace/service/record_aggregator.h"
+#include "syzygy/trace/service/session_trace_file_writer.h"
+#include "syzygy/trace/service/session_trace_file_writer_factory.h"
+
+namespace trace {
+namespace service {
+
+// A trace file writer that aggregates records with a chain of aggregators.
+class AggregatingTraceFileWriter : public SessionTraceFileWriter {
+ public:
+  // @name Constructors. See SessionTraceFileWriter.
+  // @{
+  AggregatingTraceFileWriter(base::MessageLoop* message_loop,
+                             const base::FilePath& trace_directory);
+  AggregatingTraceFileWriter(TraceFileWriterPool* writer_pool,
+                             const base::FilePath& trace_directory);
+  // @}
+
+  // Appends an aggregator to the chain. Each record is offered to the
+  // aggregators in turn, until one absorbs it. This must be called before
+  // Open.
+  // @param aggregator the aggregator to append.
+  void AddAggregator(std::unique_ptr<RecordAggregator> aggregator);
+
+  // Sets whether the indexed frequency records written are converted to
+  // their sparse encoding, where it is smaller. This applies to the records
+  // written as is as well as to the aggregates. This must be called before
+  // Open.
+  // @param sparse true to write sparse indexed frequency records.
+  void set_sparse_indexed_frequencies(bool sparse) {
+    sparse_indexed_frequencies_ = sparse;
+  }
+
+  // @name BufferConsumer implementation.
+  // @{
+  bool Close(Session* session) override;
+  // @}
+
+ protected:
+  // A record held back until the session closes.
+  struct DeferredRecord {
+    uint32_t thread_id;
+    RecordPrefix prefix;
+    std::vector<uint8_t> data;
+  };
+
+  ~AggregatingTraceFileWriter() override;
+
+  // @name SessionTraceFileWriter implementation.
+  // @{
+  void ProcessBuffer(void* data, size_t length) override;
+  // @}
+
+  // Offers a record to the aggregators.
+  // @returns true if the record was absorbed, false if it is to be written.
+  bool AggregateRecordUnlocked(uint32_t thread_id,
+                               const RecordPrefix& prefix,
+                               const void* data);
+
+  // Protects the aggregators and deferred records, as buffers may be
+  // processed on several threads of the writer pool at once.
+  base::Lock aggregator_lock_;
+
+  // The chain of aggregators. Under aggregator_lock_.
+  std::vector<std::unique_ptr<RecordAggregator>> aggregators_;
+
+  // The process detach events, in order. Under aggregator_lock_.
+  std::vector<DeferredRecord> deferred_records_;
+
+  // Whether indexed frequency records are written sparse.
+  bool sparse_indexed_frequencies_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AggregatingTraceFileWriter);
+};
+
+// Creates AggregatingTraceFileWriter instances with a given set of
+// aggregators.
+class AggregatingTraceFileWriterFactory : public SessionTraceFileWriterFactory {
+ public:
+  // @name Constructors. See SessionTraceFileWriterFactory.
+  // @{
+  explicit AggregatingTraceFileWriterFactory(base::MessageLoop* message_loop);
+  explicit AggregatingTraceFileWriterFactory(TraceFileWriterPool* writer_pool);
+  // @}
+
+  // @name BufferConsumerFactory implementation.
+  // @{
+  bool CreateConsumer(scoped_refptr<BufferConsumer>* consumer) override;
+  // @}
+
+  // Sets whether indexed frequency records are summed per module.
+  void set_aggregate_indexed_frequencies(bool aggregate) {
+    aggregate_indexed_frequencies_ = aggregate;
+  }
+
+  // Sets whether invocation batches are summed per thread.
+  void set_aggregate_invocations(bool aggregate) {
+    aggregate_invocations_ = aggregate;
+  }
+
+  // Sets whether indexed frequency records are written in their sparse
+  // encoding.
+  void set_sparse_indexed_frequencies(bool sparse) {
+    sparse_indexed_frequencies_ = sparse;
+  }
+
+  // Sets the base names of the modules whose module events and indexed
+  // frequency records are kept. If empty, the records of all modules are
+  // kept.
+  void set_module_filter(const std::set<std::wstring>& module_names) {
+    module_filter_ = module_names;
+  }
+
+ protected:
+  // The configuration of the writers created.
+  bool aggregate_indexed_frequencies_;
+  bool aggregate_invocations_;
+  bool sparse_indexed_frequencies_;
+  std::set<std::wstring> module_filter_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AggregatingTraceFileWriterFactory);
+};
+
+}  // namespace service
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_SERVICE_AGGREGATING_TRACE_FILE_WRITER_H_
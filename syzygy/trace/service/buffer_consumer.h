@@ -17,6 +17,8 @@
 #ifndef SYZYGY_TRACE_SERVICE_BUFFER_CONSUMER_H_
 #define SYZYGY_TRACE_SERVICE_BUFFER_CONSUMER_H_
 
+#include <stdint.h>
+
 #include "base/files/file_path.h"
 #include "base/memory/ref_counted.h"
 
@@ -57,6 +59,10 @@ class BufferConsumer : public base::RefCountedThreadSafe<BufferConsumer> {
   // expect that buffers are sized as a multiple of the block size.
   virtual size_t block_size() const = 0;
 
+  // Get the number of bytes written so far while consuming buffers. This
+  // may be called on any thread.
+  virtual uint64_t GetBytesWritten() = 0;
+
  protected:
   virtual ~BufferConsumer() = 0 {}
   friend class base::RefCountedThreadSafe<BufferConsumer>;
@@ -66,6 +72,8 @@ class BufferConsumer : public base::RefCountedThreadSafe<BufferConsumer> {
 // and manage buffer consumers when sessions are instantiated.
 class BufferConsumerFactory {
  public:
+  virtual ~BufferConsumerFactory() {}
+
   // Creates a new consumer.
   virtual bool CreateConsumer(scoped_refptr<BufferConsumer>* consumer) = 0;
 };
@@ -19,12 +19,14 @@
 #include "syzygy/trace/service/buffer_pool.h"
 
 #include "base/logging.h"
+#include "syzygy/common/align.h"
 #include "syzygy/common/com_utils.h"
+#include "syzygy/common/large_pages.h"
 
 namespace trace {
 namespace service {
 
-BufferPool::BufferPool() {
+BufferPool::BufferPool() : large_page_size_(0) {
 }
 
 BufferPool::~BufferPool() {
@@ -32,7 +34,8 @@ BufferPool::~BufferPool() {
 
 bool BufferPool::Init(Session* session,
                       size_t num_buffers,
-                      size_t buffer_size) {
+                      size_t buffer_size,
+                      bool use_large_pages) {
   DCHECK(num_buffers != 0);
   DCHECK(buffer_size != 0);
   DCHECK(!handle_.IsValid());
@@ -41,10 +44,32 @@ bool BufferPool::Init(Session* session,
 
   VLOG(1) << "Creating " << (mapping_size >> 20) << "MB memory pool.";
 
+  // Try to back the segment with large pages first. The section then has to
+  // be committed at once, and its size be a multiple of the large page size.
+  base::win::ScopedHandle new_handle;
+  if (use_large_pages) {
+    size_t large_page_size = ::common::EnableLargePages();
+    if (large_page_size != 0) {
+      size_t large_mapping_size =
+          ::common::AlignUp(mapping_size, large_page_size);
+      new_handle.Set(::CreateFileMapping(
+          NULL, NULL, PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, 0,
+          large_mapping_size, NULL));
+      if (new_handle.IsValid()) {
+        mapping_size = large_mapping_size;
+        large_page_size_ = large_page_size;
+      }
+    }
+    if (!new_handle.IsValid())
+      LOG(WARNING) << "Unable to back the buffer pool with large pages.";
+  }
+
   // Create a pagefile backed memory mapped file. This will be cut up into a
   // pool of buffers.
-  base::win::ScopedHandle new_handle(
-      ::CreateFileMapping(NULL, NULL, PAGE_READWRITE, 0, mapping_size, NULL));
+  if (!new_handle.IsValid()) {
+    new_handle.Set(::CreateFileMapping(NULL, NULL, PAGE_READWRITE, 0,
+                                       mapping_size, NULL));
+  }
   if (!new_handle.IsValid()) {
     DWORD error = ::GetLastError();
     LOG(ERROR) << "Failed to allocate buffer: " << ::common::LogWe(error)
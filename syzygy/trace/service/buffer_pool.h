@@ -24,6 +24,7 @@
 #include <utility>
 #include <vector>
 
+#include "base/time/time.h"
 #include "base/win/scoped_handle.h"
 #include "syzygy/trace/rpc/call_trace_rpc.h"
 
@@ -59,6 +60,10 @@ struct Buffer : public ::CallTraceBuffer {
   Session* session;
   BufferPool* pool;
   BufferState state;
+
+  // When the buffer last became pending write. This is used to measure how
+  // far the writer lags behind.
+  base::TimeTicks pending_write_time;
 };
 
 // A BufferPool manages a collection of buffers that all belong to the same
@@ -70,7 +75,12 @@ class BufferPool {
 
   // Allocates and maps a shared memory segment sufficiently large for
   // @p num_buffers, each of size @p buffer_size.
-  bool Init(Session* session, size_t num_buffers, size_t buffer_size);
+  // @param use_large_pages If true, tries to back the segment with large
+  //     pages, falling back to regular pages if they can't be used.
+  bool Init(Session* session,
+            size_t num_buffers,
+            size_t buffer_size,
+            bool use_large_pages);
 
   // Updates each buffer in buffers_ with @p client_handle, which should be
   // a copy of handle_, valid in the client process these buffers are to be
@@ -84,11 +94,17 @@ class BufferPool {
   // Returns this pools shared memory segment handle.
   HANDLE handle() const { return handle_.Get(); }
 
+  // Returns the size of the large pages backing the shared memory segment, or
+  // 0 if it is backed by regular pages. Views of a segment backed by large
+  // pages must be aligned to this size.
+  size_t large_page_size() const { return large_page_size_; }
+
  private:
   typedef std::vector<Buffer> BufferCollection;
   // Sadly ScopedHandle is not const correct.
   mutable base::win::ScopedHandle handle_;
   BufferCollection buffers_;
+  size_t large_page_size_;
 
   DISALLOW_COPY_AND_ASSIGN(BufferPool);
 };
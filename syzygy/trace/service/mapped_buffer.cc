@@ -37,8 +37,16 @@ bool MappedBuffer::Map() {
 
   // Mapped views of a file have be in chunks that respect the allocation
   // granularity. We choose a view of the file that respects the granularity
-  // but also spans the area of interest.
-  start = common::AlignDown(start, sys_info.dwAllocationGranularity);
+  // but also spans the area of interest. Views of a file backed by large
+  // pages must also have a size that is a multiple of the large page size.
+  if (pool->large_page_size() != 0) {
+    start = static_cast<DWORD>(
+        common::AlignDown(start, pool->large_page_size()));
+    end = static_cast<DWORD>(common::AlignUp(end, pool->large_page_size()));
+    DCHECK_LE(end, buffer_->mapping_size);
+  } else {
+    start = common::AlignDown(start, sys_info.dwAllocationGranularity);
+  }
 
   // Map a view of the shared memory file into this process. We only bring in
   // the portion of the mapping that corresponds to this buffer.
@@ -33,6 +33,7 @@ class DummyBufferConsumer : public BufferConsumer {
   virtual bool Close(Session* session) override { return true; }
   virtual bool ConsumeBuffer(Buffer* buffer) override { return true; }
   virtual size_t block_size() const override { return 1024; }
+  virtual uint64_t GetBytesWritten() override { return 0; }
 };
 
 // A factory for producing DummyBufferConsumer instances.
@@ -61,7 +62,7 @@ class MappedBufferTest : public testing::Test {
     session = new Session(service.get());
 
     pool.reset(new BufferPool());
-    ASSERT_TRUE(pool->Init(session.get(), 2, kBufferSize));
+    ASSERT_TRUE(pool->Init(session.get(), 2, kBufferSize, false));
 
     b1 = pool->begin();
     b2 = b1 + 1;
@@ -189,5 +190,27 @@ TEST_F(MappedBufferTest, MappedViewIsReaped) {
   EXPECT_EQ(MEM_FREE, info.State);
 }
 
+TEST_F(MappedBufferTest, LargePagesFallBackGracefully) {
+  BufferPool large_pool;
+  ASSERT_TRUE(large_pool.Init(session.get(), 2, kBufferSize, true));
+  ASSERT_EQ(2, large_pool.end() - large_pool.begin());
+
+  // The segment is padded to a whole number of large pages, if backed by
+  // them.
+  Buffer* buffer = large_pool.begin() + 1;
+  if (large_pool.large_page_size() != 0) {
+    EXPECT_EQ(0u, buffer->mapping_size % large_pool.large_page_size());
+  } else {
+    EXPECT_EQ(2 * kBufferSize, buffer->mapping_size);
+  }
+
+  // Either way the buffers can be mapped.
+  TestMappedBuffer mb(buffer);
+  EXPECT_TRUE(mb.Map());
+  EXPECT_TRUE(mb.data() != NULL);
+  EXPECT_EQ(mb.data(), mb.base() + kBufferSize);
+  EXPECT_TRUE(mb.Unmap());
+}
+
 }  // namespace service
 }  // namespace trace
@@ -0,0 +1,464 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/record_aggregator.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "base/files/file_path.h"
+#include "base/logging.h"
+#include "base/strings/string_util.h"
+#include "syzygy/common/align.h"
+
+namespace trace {
+namespace service {
+
+namespace {
+
+const size_t kSegmentHeaderLength =
+    sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+
+// Adds the frequencies of @p values to those of @p sums, saturating.
+template <typename T>
+void AddFrequencies(const void* values, size_t count, void* sums) {
+  const T* value = reinterpret_cast<const T*>(values);
+  T* sum = reinterpret_cast<T*>(sums);
+  for (size_t i = 0; i < count; ++i) {
+    T room = std::numeric_limits<T>::max() - sum[i];
+    sum[i] += std::min(room, value[i]);
+  }
+}
+
+// @returns the size of the frequency data of an indexed frequency record.
+uint64_t GetFrequencyDataSize(const TraceIndexedFrequencyData& data) {
+  return static_cast<uint64_t>(data.num_entries) * data.num_columns *
+      data.frequency_size;
+}
+
+// The least number of bytes that a run of a sparse indexed frequency record
+// takes beyond its frequencies. A gap of zero entries of no more than this
+// is cheaper kept in a run than skipped.
+const size_t kMinSparseRunOverhead = 2;
+
+// Appends @p value to @p buffer as a varint.
+void AppendVarint(uint64_t value, std::vector<uint8_t>* buffer) {
+  uint8_t bytes[kMaxVarintLength] = {};
+  size_t length = EncodeVarint(value, bytes);
+  buffer->insert(buffer->end(), bytes, bytes + length);
+}
+
+// @returns true if the frequencies of entry @p entry are all zero.
+bool IsZeroEntry(const uint8_t* frequencies, size_t entry_size, size_t entry) {
+  const uint8_t* begin = frequencies + entry * entry_size;
+  for (size_t i = 0; i < entry_size; ++i) {
+    if (begin[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool EncodeSparseIndexedFrequencyData(const void* data,
+                                      size_t size,
+                                      std::vector<uint8_t>* sparse) {
+  DCHECK(data != NULL);
+  DCHECK(sparse != NULL);
+
+  const size_t kHeaderSize =
+      offsetof(TraceIndexedFrequencyData, frequency_data);
+  if (size < kHeaderSize)
+    return false;
+  TraceIndexedFrequencyData header = {};
+  ::memcpy(&header, data, kHeaderSize);
+  if (header.frequency_size != 1 && header.frequency_size != 2 &&
+      header.frequency_size != 4) {
+    return false;
+  }
+  size_t entry_size = header.num_columns * header.frequency_size;
+  if (entry_size == 0 || size - kHeaderSize < GetFrequencyDataSize(header))
+    return false;
+
+  TraceSparseIndexedFrequencyData sparse_header = {};
+  sparse_header.module_base_addr = header.module_base_addr;
+  sparse_header.module_base_size = header.module_base_size;
+  sparse_header.module_checksum = header.module_checksum;
+  sparse_header.module_time_date_stamp = header.module_time_date_stamp;
+  sparse_header.num_entries = header.num_entries;
+  sparse_header.num_columns = header.num_columns;
+  sparse_header.data_type = header.data_type;
+  sparse_header.frequency_size = header.frequency_size;
+  const uint8_t* sparse_begin = reinterpret_cast<const uint8_t*>(
+      &sparse_header);
+  sparse->assign(sparse_begin,
+                 sparse_begin + offsetof(TraceSparseIndexedFrequencyData,
+                                         runs));
+
+  const uint8_t* frequencies =
+      reinterpret_cast<const uint8_t*>(data) + kHeaderSize;
+  size_t num_entries = header.num_entries;
+  size_t previous_run_end = 0;
+  size_t entry = 0;
+  while (sparse->size() < size) {
+    while (entry < num_entries && IsZeroEntry(frequencies, entry_size, entry))
+      ++entry;
+    if (entry == num_entries)
+      break;
+
+    // Extend the run over the entries up to the next gap of zero entries
+    // that is worth skipping.
+    size_t run_begin = entry;
+    size_t run_end = entry;
+    while (entry < num_entries) {
+      if (!IsZeroEntry(frequencies, entry_size, entry)) {
+        run_end = ++entry;
+        continue;
+      }
+      size_t gap_end = entry + 1;
+      while (gap_end < num_entries &&
+             IsZeroEntry(frequencies, entry_size, gap_end)) {
+        ++gap_end;
+      }
+      if (gap_end == num_entries ||
+          (gap_end - entry) * entry_size > kMinSparseRunOverhead) {
+        break;
+      }
+      entry = gap_end;
+    }
+
+    AppendVarint(run_begin - previous_run_end, sparse);
+    AppendVarint(run_end - run_begin, sparse);
+    sparse->insert(sparse->end(), frequencies + run_begin * entry_size,
+                   frequencies + run_end * entry_size);
+    previous_run_end = run_end;
+    entry = run_end;
+  }
+
+  return sparse->size() < size;
+}
+
+AggregateWriter::AggregateWriter(size_t block_size)
+    : block_size_(block_size), sparse_indexed_frequencies_(false) {
+  DCHECK_LT(0u, block_size);
+}
+
+void AggregateWriter::AppendRecord(uint32_t thread_id,
+                                   uint64_t timestamp,
+                                   uint16_t type,
+                                   const void* data,
+                                   size_t size) {
+  DCHECK(data != NULL || size == 0);
+
+  std::vector<uint8_t> sparse;
+  if (sparse_indexed_frequencies_ && type == TRACE_INDEXED_FREQUENCY &&
+      EncodeSparseIndexedFrequencyData(data, size, &sparse)) {
+    type = TRACE_SPARSE_INDEXED_FREQUENCY;
+    data = sparse.data();
+    size = sparse.size();
+  }
+
+  // Start a new segment for a new thread.
+  TraceFileSegmentHeader* header = NULL;
+  if (!segments_.empty()) {
+    header = reinterpret_cast<TraceFileSegmentHeader*>(
+        segments_.back().data() + sizeof(RecordPrefix));
+    if (header->thread_id != thread_id)
+      header = NULL;
+  }
+  if (header == NULL) {
+    segments_.push_back(std::vector<uint8_t>(kSegmentHeaderLength));
+    RecordPrefix* prefix =
+        reinterpret_cast<RecordPrefix*>(segments_.back().data());
+    prefix->timestamp = timestamp;
+    prefix->size = sizeof(TraceFileSegmentHeader);
+    prefix->type = TraceFileSegmentHeader::kTypeId;
+    prefix->version.hi = TRACE_VERSION_HI;
+    prefix->version.lo = TRACE_VERSION_LO;
+    header = reinterpret_cast<TraceFileSegmentHeader*>(prefix + 1);
+    header->thread_id = thread_id;
+    header->segment_length = 0;
+  }
+
+  // Grow the segment to fit the record, padded to a multiple of the block
+  // size, and append it.
+  std::vector<uint8_t>& segment = segments_.back();
+  size_t offset = kSegmentHeaderLength + header->segment_length;
+  size_t record_size = sizeof(RecordPrefix) + size;
+  segment.resize(::common::AlignUp(offset + record_size, block_size_));
+  header = reinterpret_cast<TraceFileSegmentHeader*>(
+      segment.data() + sizeof(RecordPrefix));
+  header->segment_length += record_size;
+
+  RecordPrefix* prefix = reinterpret_cast<RecordPrefix*>(&segment[offset]);
+  prefix->timestamp = timestamp;
+  prefix->size = size;
+  prefix->type = type;
+  prefix->version.hi = TRACE_VERSION_HI;
+  prefix->version.lo = TRACE_VERSION_LO;
+  if (size != 0)
+    ::memcpy(prefix + 1, data, size);
+}
+
+IndexedFrequencyAggregator::Key::Key(const TraceIndexedFrequencyData& data)
+    : module_base_addr(data.module_base_addr),
+      module_base_size(data.module_base_size),
+      module_checksum(data.module_checksum),
+      module_time_date_stamp(data.module_time_date_stamp),
+      num_entries(data.num_entries),
+      num_columns(data.num_columns),
+      data_type(data.data_type),
+      frequency_size(data.frequency_size) {
+}
+
+bool IndexedFrequencyAggregator::Key::operator<(const Key& other) const {
+  if (module_base_addr != other.module_base_addr)
+    return module_base_addr < other.module_base_addr;
+  if (module_base_size != other.module_base_size)
+    return module_base_size < other.module_base_size;
+  if (module_checksum != other.module_checksum)
+    return module_checksum < other.module_checksum;
+  if (module_time_date_stamp != other.module_time_date_stamp)
+    return module_time_date_stamp < other.module_time_date_stamp;
+  if (num_entries != other.num_entries)
+    return num_entries < other.num_entries;
+  if (num_columns != other.num_columns)
+    return num_columns < other.num_columns;
+  if (data_type != other.data_type)
+    return data_type < other.data_type;
+  return frequency_size < other.frequency_size;
+}
+
+IndexedFrequencyAggregator::IndexedFrequencyAggregator() {
+}
+
+IndexedFrequencyAggregator::~IndexedFrequencyAggregator() {
+}
+
+bool IndexedFrequencyAggregator::AggregateRecord(uint32_t thread_id,
+                                                 const RecordPrefix& prefix,
+                                                 const void* data) {
+  DCHECK(data != NULL);
+
+  if (prefix.type != TraceIndexedFrequencyData::kTypeId)
+    return false;
+
+  // Records that can't be summed are written as is, for the parser to
+  // complain about. The header is copied, as the client could be changing
+  // it as we go.
+  const size_t kHeaderSize =
+      offsetof(TraceIndexedFrequencyData, frequency_data);
+  if (prefix.size < kHeaderSize)
+    return false;
+  TraceIndexedFrequencyData header = {};
+  ::memcpy(&header, data, kHeaderSize);
+  uint64_t data_size = GetFrequencyDataSize(header);
+  if (prefix.size - kHeaderSize < data_size)
+    return false;
+  if (header.frequency_size != 1 && header.frequency_size != 2 &&
+      header.frequency_size != 4) {
+    return false;
+  }
+
+  const uint8_t* frequency_data =
+      reinterpret_cast<const uint8_t*>(data) + kHeaderSize;
+  Key key(header);
+  SumMap::iterator it = sums_.find(key);
+  if (it == sums_.end()) {
+    Sum& sum = sums_[key];
+    sum.thread_id = thread_id;
+    sum.timestamp = prefix.timestamp;
+    sum.record.resize(kHeaderSize + static_cast<size_t>(data_size));
+    ::memcpy(sum.record.data(), &header, kHeaderSize);
+    ::memcpy(sum.record.data() + kHeaderSize, frequency_data,
+             static_cast<size_t>(data_size));
+    return true;
+  }
+
+  Sum& sum = it->second;
+  sum.timestamp = std::max(sum.timestamp, prefix.timestamp);
+  uint8_t* sum_data = sum.record.data() + kHeaderSize;
+  size_t count = static_cast<size_t>(data_size / header.frequency_size);
+  switch (header.frequency_size) {
+    case 1:
+      AddFrequencies<uint8_t>(frequency_data, count, sum_data);
+      break;
+    case 2:
+      AddFrequencies<uint16_t>(frequency_data, count, sum_data);
+      break;
+    case 4:
+      AddFrequencies<uint32_t>(frequency_data, count, sum_data);
+      break;
+  }
+
+  return true;
+}
+
+void IndexedFrequencyAggregator::WriteAggregate(AggregateWriter* writer) {
+  DCHECK(writer != NULL);
+
+  for (const auto& entry : sums_) {
+    const Sum& sum = entry.second;
+    writer->AppendRecord(sum.thread_id, sum.timestamp,
+                         TraceIndexedFrequencyData::kTypeId,
+                         sum.record.data(), sum.record.size());
+  }
+  sums_.clear();
+}
+
+const size_t InvocationBatchAggregator::kMaxInvocationsPerRecord = 1024;
+
+InvocationBatchAggregator::Key::Key(uint32_t thread_id,
+                                    const InvocationInfo& info)
+    : thread_id(thread_id),
+      caller(info.caller),
+      function(info.function),
+      flags(info.flags),
+      caller_offset(info.caller_offset) {
+}
+
+bool InvocationBatchAggregator::Key::operator<(const Key& other) const {
+  if (thread_id != other.thread_id)
+    return thread_id < other.thread_id;
+  if (caller != other.caller)
+    return caller < other.caller;
+  if (function != other.function)
+    return function < other.function;
+  if (flags != other.flags)
+    return flags < other.flags;
+  return caller_offset < other.caller_offset;
+}
+
+InvocationBatchAggregator::InvocationBatchAggregator() {
+}
+
+InvocationBatchAggregator::~InvocationBatchAggregator() {
+}
+
+bool InvocationBatchAggregator::AggregateRecord(uint32_t thread_id,
+                                                const RecordPrefix& prefix,
+                                                const void* data) {
+  DCHECK(data != NULL);
+
+  if (prefix.type != TraceBatchInvocationInfo::kTypeId)
+    return false;
+
+  // As in the parser, batches must hold a whole number of invocations.
+  if (prefix.size % sizeof(InvocationInfo) != 0)
+    return false;
+
+  const InvocationInfo* infos = reinterpret_cast<const InvocationInfo*>(data);
+  size_t num_infos = prefix.size / sizeof(InvocationInfo);
+  for (size_t i = 0; i < num_infos; ++i) {
+    const InvocationInfo& info = infos[i];
+    Key key(thread_id, info);
+    InvocationMap::iterator it = invocations_.find(key);
+    if (it == invocations_.end()) {
+      invocations_.insert(std::make_pair(key, info));
+      continue;
+    }
+
+    InvocationInfo& sum = it->second;
+    sum.num_calls += info.num_calls;
+    sum.cycles_min = std::min(sum.cycles_min, info.cycles_min);
+    sum.cycles_max = std::max(sum.cycles_max, info.cycles_max);
+    sum.cycles_sum += info.cycles_sum;
+  }
+
+  uint64_t& timestamp = timestamps_[thread_id];
+  timestamp = std::max(timestamp, prefix.timestamp);
+
+  return true;
+}
+
+void InvocationBatchAggregator::WriteAggregate(AggregateWriter* writer) {
+  DCHECK(writer != NULL);
+
+  // The invocations are ordered by thread, so each thread's batches are
+  // written to its own segment.
+  std::vector<InvocationInfo> batch;
+  InvocationMap::const_iterator it = invocations_.begin();
+  while (it != invocations_.end()) {
+    uint32_t thread_id = it->first.thread_id;
+    batch.clear();
+    for (; it != invocations_.end() && it->first.thread_id == thread_id &&
+           batch.size() < kMaxInvocationsPerRecord; ++it) {
+      batch.push_back(it->second);
+    }
+    writer->AppendRecord(thread_id, timestamps_[thread_id],
+                         TraceBatchInvocationInfo::kTypeId, batch.data(),
+                         batch.size() * sizeof(InvocationInfo));
+  }
+
+  invocations_.clear();
+  timestamps_.clear();
+}
+
+ModuleFilter::ModuleFilter(const std::set<std::wstring>& module_names) {
+  for (const std::wstring& module_name : module_names)
+    module_names_.insert(base::ToLowerASCII(module_name));
+}
+
+ModuleFilter::~ModuleFilter() {
+}
+
+bool ModuleFilter::AggregateRecord(uint32_t /* thread_id */,
+                                   const RecordPrefix& prefix,
+                                   const void* data) {
+  DCHECK(data != NULL);
+
+  switch (prefix.type) {
+    case TRACE_PROCESS_ATTACH_EVENT:
+    case TRACE_PROCESS_DETACH_EVENT:
+    case TRACE_THREAD_ATTACH_EVENT:
+    case TRACE_THREAD_DETACH_EVENT: {
+      if (prefix.size < sizeof(TraceModuleData))
+        return false;
+      const TraceModuleData* module =
+          reinterpret_cast<const TraceModuleData*>(data);
+      if (!IsModuleKept(*module))
+        return true;
+      kept_modules_.insert(module->module_base_addr);
+      return false;
+    }
+
+    case TRACE_INDEXED_FREQUENCY: {
+      if (prefix.size < offsetof(TraceIndexedFrequencyData, frequency_data))
+        return false;
+      const TraceIndexedFrequencyData* record =
+          reinterpret_cast<const TraceIndexedFrequencyData*>(data);
+      return kept_modules_.count(record->module_base_addr) == 0;
+    }
+
+    default:
+      return false;
+  }
+}
+
+void ModuleFilter::WriteAggregate(AggregateWriter* /* writer */) {
+  // Nothing is aggregated.
+}
+
+bool ModuleFilter::IsModuleKept(const TraceModuleData& module) const {
+  // The name may not be terminated if the client wrote it incompletely.
+  const size_t kMaxLength = arraysize(module.module_name);
+  std::wstring name(module.module_name,
+                    std::find(module.module_name,
+                              module.module_name + kMaxLength, L'\0'));
+  std::wstring base_name = base::FilePath(name).BaseName().value();
+  return module_names_.count(base::ToLowerASCII(base_name)) != 0;
+}
+
+}  // namespace service
+}  // namespace trace
@@ -0,0 +1,244 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file declares the RecordAggregator interface, through which the call
+// trace service aggregates or filters the records of a session before they
+// are written to its trace file, and the aggregators it provides:
+//
+//   - IndexedFrequencyAggregator sums the indexed frequency records of each
+//     module, such as the per-thread basic-block entry counts.
+//   - InvocationBatchAggregator sums the invocation batches of each thread,
+//     as the profiler flushes them.
+//   - ModuleFilter drops the module events and indexed frequency records of
+//     all but a set of modules.
+//
+// It also declares EncodeSparseIndexedFrequencyData, through which the service
+// writes the indexed frequency records in their sparse encoding.
+
+#ifndef SYZYGY_TRACE_SERVICE_RECORD_AGGREGATOR_H_
+#define SYZYGY_TRACE_SERVICE_RECORD_AGGREGATOR_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+
+namespace trace {
+namespace service {
+
+// Accumulates aggregated records into segments to be written to a trace file.
+class AggregateWriter {
+ public:
+  // @param block_size the block size of the trace file. Each segment is
+  //     padded to a multiple of it.
+  explicit AggregateWriter(size_t block_size);
+
+  // Appends a record. Consecutive records of the same thread share a segment.
+  // @param thread_id the ID of the thread the record is attributed to.
+  // @param timestamp the timestamp of the record.
+  // @param type the type of the record.
+  // @param data the data of the record.
+  // @param size the size of @p data.
+  void AppendRecord(uint32_t thread_id,
+                    uint64_t timestamp,
+                    uint16_t type,
+                    const void* data,
+                    size_t size);
+
+  // Sets whether the indexed frequency records appended are written in their
+  // sparse encoding, where it is smaller.
+  void set_sparse_indexed_frequencies(bool sparse) {
+    sparse_indexed_frequencies_ = sparse;
+  }
+
+  // @returns the segments, each of which is suitable for
+  //     TraceFileWriter::WriteRecord.
+  std::vector<std::vector<uint8_t>>& segments() { return segments_; }
+  const std::vector<std::vector<uint8_t>>& segments() const {
+    return segments_;
+  }
+
+ private:
+  // The block size of the trace file.
+  size_t block_size_;
+
+  // Whether indexed frequency records are written sparse.
+  bool sparse_indexed_frequencies_;
+
+  // The segments appended so far.
+  std::vector<std::vector<uint8_t>> segments_;
+
+  DISALLOW_COPY_AND_ASSIGN(AggregateWriter);
+};
+
+// Encodes an indexed frequency record as a TraceSparseIndexedFrequencyData.
+// @param data the TraceIndexedFrequencyData record.
+// @param size the size of @p data.
+// @param sparse receives the sparse record.
+// @returns true if the sparse record is smaller than @p data, false if
+//     @p data is to be written as is, or isn't a valid record.
+bool EncodeSparseIndexedFrequencyData(const void* data,
+                                      size_t size,
+                                      std::vector<uint8_t>* sparse);
+
+// The interface of the aggregators of a session's records. The records are
+// offered to an aggregator as the session's buffers are written, and the
+// aggregator writes what it absorbed as the session closes. An aggregator is
+// used for a single session, and isn't called on several threads at once.
+class RecordAggregator {
+ public:
+  virtual ~RecordAggregator() {}
+
+  // Offers a record to this aggregator.
+  // @param thread_id the ID of the thread that wrote the record.
+  // @param prefix the prefix of the record.
+  // @param data the data of the record, of prefix.size bytes.
+  // @returns true if the record was absorbed, and is not to be written to the
+  //     trace file, false if it is to be written as is.
+  virtual bool AggregateRecord(uint32_t thread_id,
+                               const RecordPrefix& prefix,
+                               const void* data) = 0;
+
+  // Writes the records aggregated so far.
+  // @param writer the writer to which to append the aggregated records.
+  virtual void WriteAggregate(AggregateWriter* writer) = 0;
+};
+
+// Sums the indexed frequency records of each module. The sums saturate at
+// the largest value of the frequency size of the records.
+class IndexedFrequencyAggregator : public RecordAggregator {
+ public:
+  IndexedFrequencyAggregator();
+  ~IndexedFrequencyAggregator() override;
+
+  // @name RecordAggregator implementation.
+  // @{
+  bool AggregateRecord(uint32_t thread_id,
+                       const RecordPrefix& prefix,
+                       const void* data) override;
+  void WriteAggregate(AggregateWriter* writer) override;
+  // @}
+
+ protected:
+  // Identifies the records that may be summed.
+  struct Key {
+    explicit Key(const TraceIndexedFrequencyData& data);
+    bool operator<(const Key& other) const;
+
+    ModuleAddr module_base_addr;
+    size_t module_base_size;
+    uint32_t module_checksum;
+    uint32_t module_time_date_stamp;
+    uint32_t num_entries;
+    uint32_t num_columns;
+    uint8_t data_type;
+    uint8_t frequency_size;
+  };
+
+  // The sum of the records with a given key.
+  struct Sum {
+    // The thread of the first record summed, and the timestamp of the last.
+    uint32_t thread_id;
+    uint64_t timestamp;
+    // The summed record, a TraceIndexedFrequencyData.
+    std::vector<uint8_t> record;
+  };
+
+  typedef std::map<Key, Sum> SumMap;
+  SumMap sums_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(IndexedFrequencyAggregator);
+};
+
+// Sums the invocation batches of each thread, by caller and function.
+class InvocationBatchAggregator : public RecordAggregator {
+ public:
+  // The maximum number of invocations written per record.
+  static const size_t kMaxInvocationsPerRecord;
+
+  InvocationBatchAggregator();
+  ~InvocationBatchAggregator() override;
+
+  // @name RecordAggregator implementation.
+  // @{
+  bool AggregateRecord(uint32_t thread_id,
+                       const RecordPrefix& prefix,
+                       const void* data) override;
+  void WriteAggregate(AggregateWriter* writer) override;
+  // @}
+
+ protected:
+  // Identifies the invocations that may be summed.
+  struct Key {
+    Key(uint32_t thread_id, const InvocationInfo& info);
+    bool operator<(const Key& other) const;
+
+    uint32_t thread_id;
+    const void* caller;
+    const void* function;
+    uint32_t flags;
+    uint32_t caller_offset;
+  };
+
+  typedef std::map<Key, InvocationInfo> InvocationMap;
+  InvocationMap invocations_;
+
+  // The timestamp of the last batch of each thread.
+  std::map<uint32_t, uint64_t> timestamps_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(InvocationBatchAggregator);
+};
+
+// Drops the module events and the indexed frequency records of the modules
+// whose base names aren't in a given set. Other records are written as is.
+class ModuleFilter : public RecordAggregator {
+ public:
+  // @param module_names the base names of the modules to keep. These are
+  //     compared without regard to case.
+  explicit ModuleFilter(const std::set<std::wstring>& module_names);
+  ~ModuleFilter() override;
+
+  // @name RecordAggregator implementation.
+  // @{
+  bool AggregateRecord(uint32_t thread_id,
+                       const RecordPrefix& prefix,
+                       const void* data) override;
+  void WriteAggregate(AggregateWriter* writer) override;
+  // @}
+
+ protected:
+  // @returns true if @p module is to be kept.
+  bool IsModuleKept(const TraceModuleData& module) const;
+
+  // The lower-case base names of the modules to keep.
+  std::set<std::wstring> module_names_;
+
+  // The base addresses of the kept modules seen so far.
+  std::set<ModuleAddr> kept_modules_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ModuleFilter);
+};
+
+}  // namespace service
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_SERVICE_RECORD_AGGREGATOR_H_
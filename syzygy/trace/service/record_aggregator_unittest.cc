@@ -0,0 +1,314 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/record_aggregator.h"
+
+#include "gtest/gtest.h"
+#include "syzygy/trace/parse/parse_utils.h"
+
+namespace trace {
+namespace service {
+
+namespace {
+
+const size_t kBlockSize = 512;
+const size_t kSegmentHeaderLength =
+    sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+
+RecordPrefix MakePrefix(uint16_t type, size_t size, uint64_t timestamp) {
+  RecordPrefix prefix = {};
+  prefix.timestamp = timestamp;
+  prefix.size = static_cast<uint32_t>(size);
+  prefix.type = type;
+  prefix.version.hi = TRACE_VERSION_HI;
+  prefix.version.lo = TRACE_VERSION_LO;
+  return prefix;
+}
+
+// Builds an indexed frequency record with 1-byte frequencies.
+std::vector<uint8_t> MakeFrequencyRecord(ModuleAddr module,
+                                         const std::vector<uint8_t>& values) {
+  const size_t kHeaderSize =
+      offsetof(TraceIndexedFrequencyData, frequency_data);
+  std::vector<uint8_t> record(kHeaderSize + values.size());
+  TraceIndexedFrequencyData* data =
+      reinterpret_cast<TraceIndexedFrequencyData*>(record.data());
+  data->module_base_addr = module;
+  data->module_base_size = 0x1000;
+  data->module_checksum = 0xCAFE;
+  data->module_time_date_stamp = 0xBABE;
+  data->num_entries = static_cast<uint32_t>(values.size());
+  data->num_columns = 1;
+  data->data_type = 1;
+  data->frequency_size = 1;
+  ::memcpy(data->frequency_data, values.data(), values.size());
+  return record;
+}
+
+TraceModuleData MakeModule(ModuleAddr base, const wchar_t* name) {
+  TraceModuleData module = {};
+  module.module_base_addr = base;
+  module.module_base_size = 0x1000;
+  ::wcscpy_s(module.module_name, name);
+  return module;
+}
+
+// @returns the record at @p offset of the records of @p segment.
+const RecordPrefix* GetRecord(const std::vector<uint8_t>& segment,
+                              size_t offset) {
+  return reinterpret_cast<const RecordPrefix*>(
+      segment.data() + kSegmentHeaderLength + offset);
+}
+
+}  // namespace
+
+TEST(AggregateWriterTest, AppendRecord) {
+  AggregateWriter writer(kBlockSize);
+  EXPECT_TRUE(writer.segments().empty());
+
+  const uint32_t kData = 0x12345678;
+  writer.AppendRecord(1, 10, TRACE_COMMENT, &kData, sizeof(kData));
+  writer.AppendRecord(1, 11, TRACE_COMMENT, &kData, sizeof(kData));
+  writer.AppendRecord(2, 12, TRACE_COMMENT, &kData, sizeof(kData));
+
+  // The records of each thread share a segment.
+  ASSERT_EQ(2u, writer.segments().size());
+  for (const auto& segment : writer.segments()) {
+    EXPECT_EQ(0u, segment.size() % kBlockSize);
+    const RecordPrefix* prefix =
+        reinterpret_cast<const RecordPrefix*>(segment.data());
+    EXPECT_EQ(TraceFileSegmentHeader::kTypeId, prefix->type);
+    EXPECT_EQ(sizeof(TraceFileSegmentHeader), prefix->size);
+    EXPECT_EQ(TRACE_VERSION_HI, prefix->version.hi);
+    EXPECT_EQ(TRACE_VERSION_LO, prefix->version.lo);
+  }
+
+  const TraceFileSegmentHeader* header =
+      reinterpret_cast<const TraceFileSegmentHeader*>(
+          writer.segments()[0].data() + sizeof(RecordPrefix));
+  EXPECT_EQ(1u, header->thread_id);
+  EXPECT_EQ(2 * (sizeof(RecordPrefix) + sizeof(kData)),
+            header->segment_length);
+  const RecordPrefix* record = GetRecord(writer.segments()[0],
+                                         sizeof(RecordPrefix) + sizeof(kData));
+  EXPECT_EQ(11u, record->timestamp);
+  EXPECT_EQ(TRACE_COMMENT, record->type);
+  EXPECT_EQ(sizeof(kData), record->size);
+  EXPECT_EQ(kData, *reinterpret_cast<const uint32_t*>(record + 1));
+
+  header = reinterpret_cast<const TraceFileSegmentHeader*>(
+      writer.segments()[1].data() + sizeof(RecordPrefix));
+  EXPECT_EQ(2u, header->thread_id);
+  EXPECT_EQ(sizeof(RecordPrefix) + sizeof(kData), header->segment_length);
+}
+
+TEST(AggregateWriterTest, AppendSparseIndexedFrequencies) {
+  AggregateWriter writer(kBlockSize);
+  writer.set_sparse_indexed_frequencies(true);
+
+  std::vector<uint8_t> values(1000);
+  values[10] = 1;
+  values[500] = 2;
+  std::vector<uint8_t> record = MakeFrequencyRecord(
+      reinterpret_cast<ModuleAddr>(0x10000000), values);
+  writer.AppendRecord(1, 10, TRACE_INDEXED_FREQUENCY, record.data(),
+                      record.size());
+
+  ASSERT_EQ(1u, writer.segments().size());
+  const RecordPrefix* prefix = GetRecord(writer.segments()[0], 0);
+  EXPECT_EQ(TRACE_SPARSE_INDEXED_FREQUENCY, prefix->type);
+  EXPECT_GT(record.size(), prefix->size);
+}
+
+TEST(EncodeSparseIndexedFrequencyDataTest, RoundTrips) {
+  const ModuleAddr kModule = reinterpret_cast<ModuleAddr>(0x10000000);
+
+  // Runs separated by long and short gaps of zero entries, at both ends.
+  std::vector<uint8_t> values(1000);
+  values[0] = 1;
+  values[1] = 2;
+  values[3] = 3;
+  values[400] = 4;
+  values[999] = 5;
+  std::vector<uint8_t> record = MakeFrequencyRecord(kModule, values);
+
+  std::vector<uint8_t> sparse;
+  ASSERT_TRUE(EncodeSparseIndexedFrequencyData(record.data(), record.size(),
+                                               &sparse));
+  EXPECT_GT(64u, sparse.size());
+
+  RecordPrefix prefix =
+      MakePrefix(TRACE_SPARSE_INDEXED_FREQUENCY, sparse.size(), 1);
+  uint16_t type = 0;
+  std::vector<uint8_t> expanded;
+  ASSERT_TRUE(trace::parser::ExpandCompactRecord(prefix, sparse.data(), 1,
+                                                 &type, &expanded));
+  EXPECT_EQ(TRACE_INDEXED_FREQUENCY, type);
+  EXPECT_EQ(record, expanded);
+
+  // A record with no zero entries is best left dense.
+  record = MakeFrequencyRecord(kModule, std::vector<uint8_t>(100, 1));
+  EXPECT_FALSE(EncodeSparseIndexedFrequencyData(record.data(), record.size(),
+                                                &sparse));
+
+  // As is a truncated one.
+  EXPECT_FALSE(EncodeSparseIndexedFrequencyData(record.data(),
+                                                record.size() - 1, &sparse));
+}
+
+TEST(IndexedFrequencyAggregatorTest, SumsRecordsOfEachModule) {
+  IndexedFrequencyAggregator aggregator;
+  ModuleAddr kModule1 = reinterpret_cast<ModuleAddr>(0x10000000);
+  ModuleAddr kModule2 = reinterpret_cast<ModuleAddr>(0x20000000);
+
+  // Other records aren't absorbed.
+  const uint32_t kData = 0;
+  EXPECT_FALSE(aggregator.AggregateRecord(
+      1, MakePrefix(TRACE_COMMENT, sizeof(kData), 1), &kData));
+
+  std::vector<uint8_t> record1 =
+      MakeFrequencyRecord(kModule1, std::vector<uint8_t>({1, 2, 250}));
+  std::vector<uint8_t> record2 =
+      MakeFrequencyRecord(kModule1, std::vector<uint8_t>({3, 0, 10}));
+  std::vector<uint8_t> record3 =
+      MakeFrequencyRecord(kModule2, std::vector<uint8_t>({7}));
+  EXPECT_TRUE(aggregator.AggregateRecord(
+      1, MakePrefix(TRACE_INDEXED_FREQUENCY, record1.size(), 1),
+      record1.data()));
+  EXPECT_TRUE(aggregator.AggregateRecord(
+      2, MakePrefix(TRACE_INDEXED_FREQUENCY, record2.size(), 2),
+      record2.data()));
+  EXPECT_TRUE(aggregator.AggregateRecord(
+      2, MakePrefix(TRACE_INDEXED_FREQUENCY, record3.size(), 3),
+      record3.data()));
+
+  // Truncated records aren't absorbed.
+  EXPECT_FALSE(aggregator.AggregateRecord(
+      1, MakePrefix(TRACE_INDEXED_FREQUENCY, record1.size() - 1, 4),
+      record1.data()));
+
+  AggregateWriter writer(kBlockSize);
+  aggregator.WriteAggregate(&writer);
+
+  // The sum is attributed to the thread of the first record.
+  ASSERT_EQ(2u, writer.segments().size());
+  const RecordPrefix* prefix = GetRecord(writer.segments()[0], 0);
+  EXPECT_EQ(TRACE_INDEXED_FREQUENCY, prefix->type);
+  EXPECT_EQ(record1.size(), prefix->size);
+  EXPECT_EQ(2u, prefix->timestamp);
+  const TraceIndexedFrequencyData* sum =
+      reinterpret_cast<const TraceIndexedFrequencyData*>(prefix + 1);
+  EXPECT_EQ(kModule1, sum->module_base_addr);
+  EXPECT_EQ(3u, sum->num_entries);
+  EXPECT_EQ(4u, sum->frequency_data[0]);
+  EXPECT_EQ(2u, sum->frequency_data[1]);
+  EXPECT_EQ(255u, sum->frequency_data[2]);
+
+  prefix = GetRecord(writer.segments()[1], 0);
+  sum = reinterpret_cast<const TraceIndexedFrequencyData*>(prefix + 1);
+  EXPECT_EQ(kModule2, sum->module_base_addr);
+  EXPECT_EQ(7u, sum->frequency_data[0]);
+}
+
+TEST(InvocationBatchAggregatorTest, SumsInvocationsOfEachThread) {
+  InvocationBatchAggregator aggregator;
+
+  InvocationInfo infos[3] = {};
+  infos[0].caller = reinterpret_cast<RetAddr>(0x1000);
+  infos[0].function = reinterpret_cast<FuncAddr>(0x2000);
+  infos[0].num_calls = 2;
+  infos[0].cycles_min = 10;
+  infos[0].cycles_max = 20;
+  infos[0].cycles_sum = 30;
+  infos[1] = infos[0];
+  infos[1].function = reinterpret_cast<FuncAddr>(0x3000);
+  infos[2] = infos[0];
+  infos[2].num_calls = 1;
+  infos[2].cycles_min = 5;
+  infos[2].cycles_max = 5;
+  infos[2].cycles_sum = 5;
+
+  EXPECT_TRUE(aggregator.AggregateRecord(
+      1, MakePrefix(TRACE_BATCH_INVOCATION, sizeof(infos), 1), infos));
+  EXPECT_TRUE(aggregator.AggregateRecord(
+      2, MakePrefix(TRACE_BATCH_INVOCATION, sizeof(infos[0]), 2), infos));
+
+  // Batches holding partial invocations aren't absorbed.
+  EXPECT_FALSE(aggregator.AggregateRecord(
+      1, MakePrefix(TRACE_BATCH_INVOCATION, sizeof(infos) - 1, 3), infos));
+
+  AggregateWriter writer(kBlockSize);
+  aggregator.WriteAggregate(&writer);
+
+  ASSERT_EQ(2u, writer.segments().size());
+  const RecordPrefix* prefix = GetRecord(writer.segments()[0], 0);
+  EXPECT_EQ(TRACE_BATCH_INVOCATION, prefix->type);
+  ASSERT_EQ(2 * sizeof(InvocationInfo), prefix->size);
+  const InvocationInfo* sums = reinterpret_cast<const InvocationInfo*>(
+      prefix + 1);
+  EXPECT_EQ(infos[0].function, sums[0].function);
+  EXPECT_EQ(3u, sums[0].num_calls);
+  EXPECT_EQ(5u, sums[0].cycles_min);
+  EXPECT_EQ(20u, sums[0].cycles_max);
+  EXPECT_EQ(35u, sums[0].cycles_sum);
+  EXPECT_EQ(infos[1].function, sums[1].function);
+  EXPECT_EQ(2u, sums[1].num_calls);
+
+  prefix = GetRecord(writer.segments()[1], 0);
+  ASSERT_EQ(sizeof(InvocationInfo), prefix->size);
+  sums = reinterpret_cast<const InvocationInfo*>(prefix + 1);
+  EXPECT_EQ(2u, sums[0].num_calls);
+}
+
+TEST(ModuleFilterTest, DropsRecordsOfOtherModules) {
+  std::set<std::wstring> names;
+  names.insert(L"Kept.dll");
+  ModuleFilter filter(names);
+
+  TraceModuleData kept = MakeModule(reinterpret_cast<ModuleAddr>(0x10000000),
+                                    L"C:\\foo\\KEPT.DLL");
+  TraceModuleData dropped = MakeModule(
+      reinterpret_cast<ModuleAddr>(0x20000000), L"C:\\foo\\dropped.dll");
+  EXPECT_FALSE(filter.AggregateRecord(
+      1, MakePrefix(TRACE_PROCESS_ATTACH_EVENT, sizeof(kept), 1), &kept));
+  EXPECT_TRUE(filter.AggregateRecord(
+      1, MakePrefix(TRACE_PROCESS_ATTACH_EVENT, sizeof(dropped), 1),
+      &dropped));
+  EXPECT_TRUE(filter.AggregateRecord(
+      1, MakePrefix(TRACE_THREAD_ATTACH_EVENT, sizeof(dropped), 1),
+      &dropped));
+
+  std::vector<uint8_t> kept_record = MakeFrequencyRecord(
+      kept.module_base_addr, std::vector<uint8_t>({1}));
+  std::vector<uint8_t> dropped_record = MakeFrequencyRecord(
+      dropped.module_base_addr, std::vector<uint8_t>({1}));
+  EXPECT_FALSE(filter.AggregateRecord(
+      1, MakePrefix(TRACE_INDEXED_FREQUENCY, kept_record.size(), 1),
+      kept_record.data()));
+  EXPECT_TRUE(filter.AggregateRecord(
+      1, MakePrefix(TRACE_INDEXED_FREQUENCY, dropped_record.size(), 1),
+      dropped_record.data()));
+
+  // Other records are kept.
+  const uint32_t kData = 0;
+  EXPECT_FALSE(filter.AggregateRecord(
+      1, MakePrefix(TRACE_COMMENT, sizeof(kData), 1), &kData));
+
+  AggregateWriter writer(kBlockSize);
+  filter.WriteAggregate(&writer);
+  EXPECT_TRUE(writer.segments().empty());
+}
+
+}  // namespace service
+}  // namespace trace
@@ -22,6 +22,7 @@
 #include "syzygy/trace/service/service.h"
 
 #include <memory>
+#include <vector>
 
 #include "base/bind.h"
 #include "base/callback.h"
@@ -52,6 +53,8 @@ Service::Service(BufferConsumerFactory* factory)
       num_incremental_buffers_(kDefaultNumIncrementalBuffers),
       buffer_size_in_bytes_(kDefaultBufferSize),
       max_buffers_pending_write_(kDefaultMaxBuffersPendingWrite),
+      max_session_pool_bytes_(0),
+      use_large_pages_(false),
       owner_thread_(base::PlatformThread::CurrentId()),
       buffer_consumer_factory_(factory),
       a_session_has_closed_(&lock_),
@@ -401,6 +404,45 @@ bool Service::RequestShutdown() {
   return true;
 }
 
+// RPC entry point.
+bool Service::GetStatistics(unsigned long* num_sessions,
+                            CallTraceSessionStatistics** statistics) {
+  if (num_sessions == NULL || statistics == NULL) {
+    LOG(WARNING) << "Invalid RPC parameters.";
+    return false;
+  }
+
+  *num_sessions = 0;
+  *statistics = NULL;
+
+  // Take references to the sessions so that they can be queried without
+  // holding lock_.
+  std::vector<scoped_refptr<Session>> sessions;
+  {
+    base::AutoLock auto_lock(lock_);
+    for (const auto& entry : sessions_)
+      sessions.push_back(entry.second);
+  }
+
+  if (sessions.empty())
+    return true;
+
+  // This is freed by the RPC runtime once the results are marshalled.
+  *statistics = reinterpret_cast<CallTraceSessionStatistics*>(
+      ::midl_user_allocate(sessions.size() *
+                           sizeof(CallTraceSessionStatistics)));
+  if (*statistics == NULL) {
+    LOG(ERROR) << "Failed to allocate session statistics.";
+    return false;
+  }
+
+  for (size_t i = 0; i < sessions.size(); ++i)
+    sessions[i]->GetStatistics(&(*statistics)[i]);
+  *num_sessions = static_cast<unsigned long>(sessions.size());
+
+  return true;
+}
+
 // RPC entry point.
 bool Service::CreateSession(handle_t binding,
                             SessionHandle* session_handle,
@@ -516,6 +558,11 @@ bool Service::CommitAndExchangeBuffer(SessionHandle session_handle,
     return false;
   DCHECK(session.get() != NULL);
 
+  // Buffers queued in the session's buffer exchange were filled before this
+  // one, so they are handed over first to keep the segments of each client
+  // thread in order.
+  session->DrainBufferExchange();
+
   Buffer* buffer = NULL;
   if (!session->FindBuffer(call_trace_buffer, &buffer))
     return false;
@@ -583,6 +630,34 @@ bool Service::CloseSession(SessionHandle* session_handle) {
   return true;
 }
 
+// RPC entry-point.
+bool Service::OpenBufferExchange(SessionHandle session_handle,
+                                 unsigned long* exchange_handle,
+                                 unsigned long* event_handle) {
+  if (session_handle == NULL || exchange_handle == NULL ||
+      event_handle == NULL) {
+    LOG(WARNING) << "Invalid RPC parameters.";
+    return false;
+  }
+
+  scoped_refptr<Session> session;
+  if (!GetExistingSession(session_handle, &session))
+    return false;
+  DCHECK(session.get() != NULL);
+
+  HANDLE client_exchange_handle = NULL;
+  HANDLE client_event_handle = NULL;
+  if (!session->OpenBufferExchange(&client_exchange_handle,
+                                   &client_event_handle)) {
+    return false;
+  }
+
+  *exchange_handle = reinterpret_cast<unsigned long>(client_exchange_handle);
+  *event_handle = reinterpret_cast<unsigned long>(client_event_handle);
+
+  return true;
+}
+
 bool Service::GetNewSession(ProcessId client_process_id,
                             scoped_refptr<Session>* session) {
   DCHECK(session != NULL);
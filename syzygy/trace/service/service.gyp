@@ -21,6 +21,8 @@
       'target_name': 'rpc_service_lib',
       'type': 'static_library',
       'sources': [
+        'aggregating_trace_file_writer.cc',
+        'aggregating_trace_file_writer.h',
         'buffer_consumer.h',
         'buffer_pool.cc',
         'buffer_pool.h',
@@ -28,6 +30,8 @@
         'mapped_buffer.h',
         'process_info.cc',
         'process_info.h',
+        'record_aggregator.cc',
+        'record_aggregator.h',
         'service.cc',
         'service.h',
         'service_rpc_impl.cc',
@@ -40,9 +44,15 @@
         'session_trace_file_writer_factory.h',
         'trace_file_writer.cc',
         'trace_file_writer.h',
+        'trace_file_writer_pool.cc',
+        'trace_file_writer_pool.h',
+        'trace_stream_collector.cc',
+        'trace_stream_collector.h',
       ],
       'dependencies': [
         '<(src)/base/base.gyp:base',
+        '<(src)/syzygy/common/common.gyp:common_lib',
+        '<(src)/syzygy/core/core.gyp:core_lib',
         '<(src)/syzygy/trace/common/common.gyp:trace_common_lib',
         '<(src)/syzygy/trace/rpc/rpc.gyp:call_trace_rpc_lib',
       ],
@@ -53,9 +63,12 @@
       'sources': [
         'mapped_buffer_unittest.cc',
         'process_info_unittest.cc',
+        'record_aggregator_unittest.cc',
         'service_unittest.cc',
         'session_unittest.cc',
+        'trace_file_writer_pool_unittest.cc',
         'trace_file_writer_unittest.cc',
+        'trace_stream_collector_unittest.cc',
         '<(src)/syzygy/testing/run_all_unittests.cc',
       ],
       'dependencies': [
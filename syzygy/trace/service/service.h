@@ -92,9 +92,11 @@ class Service {
   // The flags value should be bitmask composed of the values from the
   // TraceEventType enumeration (see call_trace_defs.h).
   //
-  // @note TRACE_FLAG_BATCH_ENTER is mutually exclusive with all other flags.
-  //     If TRACE_FLAG_BATCH_ENTER is set, all other flags will be ignored.
+  // @note TRACE_FLAG_BATCH_ENTER is mutually exclusive with all other flags
+  //     but TRACE_FLAG_COMPACT_RECORDS and TRACE_FLAG_FILTER_REPEATED_ENTRIES.
+  //     If TRACE_FLAG_BATCH_ENTER is set, the others will be ignored.
   void set_flags(uint32_t flags) { flags_ = flags; }
+  uint32_t flags() const { return flags_; }
 
   // Set the number of buffers by which to grow a sessions
   // buffer pool.
@@ -116,18 +118,40 @@ class Service {
     max_buffers_pending_write_ = n;
   }
 
-  // @returns the number of new buffers to be created per allocation.
+  // Sets the maximum number of bytes of buffers that a session may allocate
+  // for its pool. Requests for buffers beyond that wait for buffers to be
+  // recycled, or fail if there are none to wait for.
+  // @param n the max number of bytes, or zero for no limit.
+  void set_max_session_pool_bytes(size_t n) {
+    max_session_pool_bytes_ = n;
+  }
+
+  // Sets whether the buffer pools of the sessions should be backed by large
+  // pages. They fall back to regular pages if large pages can't be used.
+  void set_use_large_pages(bool use_large_pages) {
+    use_large_pages_ = use_large_pages;
+  }
+
+  // @returns the minimum number of new buffers to be created per allocation.
+  //     Sessions allocate more at once when their writer lags behind.
   size_t num_incremental_buffers() const { return num_incremental_buffers_; }
 
   // @returns the size (in bytes) of new buffers to be allocated.
   size_t buffer_size_in_bytes() const { return buffer_size_in_bytes_; }
 
+  // @returns true if the buffer pools should be backed by large pages.
+  bool use_large_pages() const { return use_large_pages_; }
+
   // @returns the maximum number of buffers that sessions should allow to be
   //     pending writes prior to starting to force them.
   size_t max_buffers_pending_write() const {
     return max_buffers_pending_write_;
   }
 
+  // @returns the maximum number of bytes of buffers a session may allocate,
+  //     or zero if there is no limit.
+  size_t max_session_pool_bytes() const { return max_session_pool_bytes_; }
+
   // Returns true if any of the service's subsystems are running.
   bool is_running() const {
     return rpc_is_running_ || num_active_sessions_ > 0;
@@ -168,6 +192,11 @@ class Service {
   // See call_trace_rpc.idl for further info.
   bool RequestShutdown();
 
+  // RPC implementation of CallTraceControl::GetStatistics().
+  // See call_trace_rpc.idl for further info.
+  bool GetStatistics(unsigned long* num_sessions,
+                     CallTraceSessionStatistics** statistics);
+
   // RPC implementation of CallTraceService::CreateSession().
   // See call_trace_rpc.idl for further info.
   bool CreateSession(handle_t binding,
@@ -197,6 +226,12 @@ class Service {
   // See call_trace_rpc.idl for further info.
   bool CloseSession(SessionHandle* session_handle);
 
+  // RPC implementation of CallTraceService::OpenBufferExchange().
+  // See call_trace_rpc.idl for further info.
+  bool OpenBufferExchange(SessionHandle session_handle,
+                          unsigned long* exchange_handle,
+                          unsigned long* event_handle);
+
   // Decrement the active session count.
   // @see num_active_sessions_
   void RemoveOneActiveSession();
@@ -274,6 +309,12 @@ class Service {
   // The maximum number of buffers that a session should have pending write.
   size_t max_buffers_pending_write_;
 
+  // The maximum number of bytes of buffers a session may allocate.
+  size_t max_session_pool_bytes_;
+
+  // Whether the buffer pools should be backed by large pages.
+  bool use_large_pages_;
+
   // Handle to the thread that owns/created this call trace service instance.
   base::PlatformThreadId owner_thread_;
 
@@ -14,6 +14,8 @@
 
 #include <iostream>
 #include <memory>
+#include <set>
+#include <string>
 
 #include "base/at_exit.h"
 #include "base/command_line.h"
@@ -26,16 +28,21 @@
 #include "base/process/launch.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/strings/string_piece.h"
+#include "base/strings/string_split.h"
 #include "base/strings/string_util.h"
 #include "base/strings/utf_string_conversions.h"
 #include "base/threading/thread.h"
+#include "base/win/scoped_handle.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/common/rpc/helpers.h"
 #include "syzygy/trace/common/service_util.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
+#include "syzygy/trace/service/aggregating_trace_file_writer.h"
 #include "syzygy/trace/service/service.h"
 #include "syzygy/trace/service/service_rpc_impl.h"
 #include "syzygy/trace/service/session_trace_file_writer_factory.h"
+#include "syzygy/trace/service/trace_file_writer_pool.h"
+#include "syzygy/trace/service/trace_stream_collector.h"
 
 namespace trace {
 namespace service {
@@ -50,6 +57,11 @@ const int kMinBufferSize = 1024 * 1024;
 // Minimum number of buffers to allocate.
 const int kMinBuffers = 16;
 
+// The memory cap (in MB) of the buffer pool of each session whose trace file
+// is streamed, unless one is given. This bounds how many buffers pile up when
+// the collector falls behind.
+const int kDefaultStreamSessionMemory = 64;
+
 // A static location to which the current instance id can be saved. We
 // persist it here so that OnConsoleCtrl can have access to the instance
 // id when it is invoked on the signal handler thread.
@@ -67,6 +79,18 @@ BOOL WINAPI OnConsoleCtrl(DWORD ctrl_type) {
   return FALSE;
 }
 
+// Signaled by OnCollectorConsoleCtrl to stop the trace stream collector.
+HANDLE collector_stop_event = NULL;
+
+// Handler function to be called on exit signals while collecting.
+BOOL WINAPI OnCollectorConsoleCtrl(DWORD ctrl_type) {
+  if (ctrl_type != CTRL_LOGOFF_EVENT) {
+    ::SetEvent(collector_stop_event);
+    return TRUE;
+  }
+  return FALSE;
+}
+
 const char* const kInstanceId = "instance-id";
 
 const char kUsage[] =
@@ -80,16 +104,66 @@ const char kUsage[] =
     "                     for it to be ready, and returns. The call trace\n"
     "                     service continues running in the background.\n"
     "  stop               Stop the call trace service.\n"
+    "  statistics         Print the buffer statistics of each session of the\n"
+    "                     call trace service.\n"
+    "  collect            Receive the trace files streamed by call trace\n"
+    "                     services to the pipe given by --pipe-name, and\n"
+    "                     write them to the trace directory. This runs in the\n"
+    "                     foreground until interrupted.\n"
     "\n"
     "Options:\n"
     "  --help             Show this help message.\n"
     "  --trace-dir=PATH   The directory in which to write the trace files.\n"
     "  --buffer-size=NUM  The size (in bytes) of each buffer to allocate.\n"
     "  --num-incremental-buffers=NUM\n"
-    "                     The number of buffers by which to grow the buffer\n"
-    "                     pool each time the client exhausts its available\n"
-    "                     buffer space.\n"
+    "                     The minimum number of buffers by which to grow the\n"
+    "                     buffer pool each time the client exhausts its\n"
+    "                     available buffer space. The pool grows faster when\n"
+    "                     the trace file writer lags behind the client.\n"
+    "  --max-session-memory=NUM\n"
+    "                     The maximum size (in MB) of the buffer pool of each\n"
+    "                     session. By default this is unlimited.\n"
+    "  --large-pages      Back the buffer pools with large pages when the\n"
+    "                     service holds the lock memory privilege, falling\n"
+    "                     back to regular pages otherwise.\n"
     "  --enable-exits     Enable exit tracing (off by default).\n"
+    "  --compact-records  Have the agents emit the compact encodings of their\n"
+    "                     high-rate records, where they have one.\n"
+    "  --filter-repeated-entries\n"
+    "                     Have the call trace client drop the entries into\n"
+    "                     the function it last saw entered on the same\n"
+    "                     thread. This keeps the order of first calls.\n"
+    "  --compress         Compress the segments of the trace files. Traces\n"
+    "                     are decompressed transparently when parsed.\n"
+    "  --index-segments   Append an index of the segments to the trace files,\n"
+    "                     so that parsers can skip to the segments of a\n"
+    "                     time range, thread or record type.\n"
+    "  --aggregate=TYPES  Aggregate records in the service rather than\n"
+    "                     writing each of them to the trace files. TYPES is a\n"
+    "                     comma-separated list of: frequencies (sum indexed\n"
+    "                     frequency data per module), invocations (sum the\n"
+    "                     profiler's invocation batches per thread).\n"
+    "  --sparse-frequencies\n"
+    "                     Write the indexed frequency data in a sparse\n"
+    "                     encoding, which skips the entries that are zero.\n"
+    "  --module-filter=NAMES\n"
+    "                     Only keep the module events and indexed frequency\n"
+    "                     data of the comma-separated list of module base\n"
+    "                     names.\n"
+    "  --stream-to=PIPE   Stream the trace files to the collector listening\n"
+    "                     on the named pipe PIPE, which is of the form\n"
+    "                     \\\\host\\pipe\\name, rather than writing them to\n"
+    "                     the trace directory.\n"
+    "                     Unless --max-session-memory is given, the buffer\n"
+    "                     pool of each session is capped at 64 MB, so that a\n"
+    "                     collector falling behind holds back the clients.\n"
+    "                     This can't be combined with --writer-threads.\n"
+    "  --pipe-name=PIPE   The named pipe on which to collect trace files, of\n"
+    "                     the form \\\\.\\pipe\\name.\n"
+    "  --writer-threads=NUM\n"
+    "                     Write trace files with overlapped I/O on a pool of\n"
+    "                     NUM threads. By default, they are written on a\n"
+    "                     single thread.\n"
     "  --verbose          Increase the logging verbosity to also include\n"
     "                     debug-level information.\n"
     "  --instance-id=ID   A unique identifier to use for the RPC endpoint.\n"
@@ -158,16 +232,93 @@ bool RunService(const base::CommandLine* cmd_line,
   DCHECK(cmd_line != NULL);
   DCHECK(app_cmd_line != NULL);
 
-  base::Thread writer_thread("trace-file-writer");
-  if (!writer_thread.StartWithOptions(
-          base::Thread::Options(base::MessageLoop::TYPE_IO, 0))) {
-    LOG(ERROR) << "Failed to start call trace service writer thread.";
-    return 1;
+  // Get the number of writer threads. By default buffers are written
+  // synchronously on a single thread.
+  std::wstring writer_threads_str(
+      cmd_line->GetSwitchValueNative("writer-threads"));
+  int writer_threads = 0;
+  if (!writer_threads_str.empty() &&
+      (!base::StringToInt(writer_threads_str, &writer_threads) ||
+       writer_threads < 1)) {
+    LOG(ERROR) << "Invalid number of writer threads: " << writer_threads_str
+               << ".";
+    return false;
   }
 
-  base::MessageLoop* message_loop = writer_thread.message_loop();
-  SessionTraceFileWriterFactory session_trace_file_writer_factory(message_loop);
-  Service call_trace_service(&session_trace_file_writer_factory);
+  // Get the kinds of records to aggregate, and the modules to keep.
+  bool aggregate_indexed_frequencies = false;
+  bool aggregate_invocations = false;
+  for (const std::string& type : base::SplitString(
+           cmd_line->GetSwitchValueASCII("aggregate"), ",",
+           base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    if (type == "frequencies") {
+      aggregate_indexed_frequencies = true;
+    } else if (type == "invocations") {
+      aggregate_invocations = true;
+    } else {
+      LOG(ERROR) << "Invalid record type to aggregate: " << type << ".";
+      return false;
+    }
+  }
+  std::set<std::wstring> module_filter;
+  for (const std::wstring& name : base::SplitString(
+           cmd_line->GetSwitchValueNative("module-filter"), L",",
+           base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    module_filter.insert(name);
+  }
+  bool sparse_indexed_frequencies = cmd_line->HasSwitch("sparse-frequencies");
+  bool aggregate = aggregate_indexed_frequencies || aggregate_invocations ||
+      sparse_indexed_frequencies || !module_filter.empty();
+
+  // Streams have to be written in order, which the writer pool doesn't do.
+  base::FilePath stream_pipe_name(cmd_line->GetSwitchValuePath("stream-to"));
+  if (!stream_pipe_name.empty() && writer_threads > 0) {
+    LOG(ERROR) << "Trace files can't be streamed with writer threads.";
+    return false;
+  }
+
+  // These must outlive the trace file writer factory, and the service.
+  base::Thread writer_thread("trace-file-writer");
+  TraceFileWriterPool writer_pool;
+  std::unique_ptr<SessionTraceFileWriterFactory>
+      session_trace_file_writer_factory;
+  AggregatingTraceFileWriterFactory* aggregating_factory = NULL;
+  if (writer_threads > 0) {
+    if (!writer_pool.Start(writer_threads)) {
+      LOG(ERROR) << "Failed to start call trace service writer pool.";
+      return false;
+    }
+    if (aggregate) {
+      aggregating_factory = new AggregatingTraceFileWriterFactory(&writer_pool);
+      session_trace_file_writer_factory.reset(aggregating_factory);
+    } else {
+      session_trace_file_writer_factory.reset(
+          new SessionTraceFileWriterFactory(&writer_pool));
+    }
+  } else {
+    if (!writer_thread.StartWithOptions(
+            base::Thread::Options(base::MessageLoop::TYPE_IO, 0))) {
+      LOG(ERROR) << "Failed to start call trace service writer thread.";
+      return false;
+    }
+    if (aggregate) {
+      aggregating_factory = new AggregatingTraceFileWriterFactory(
+          writer_thread.message_loop());
+      session_trace_file_writer_factory.reset(aggregating_factory);
+    } else {
+      session_trace_file_writer_factory.reset(
+          new SessionTraceFileWriterFactory(writer_thread.message_loop()));
+    }
+  }
+  if (aggregating_factory != NULL) {
+    aggregating_factory->set_aggregate_indexed_frequencies(
+        aggregate_indexed_frequencies);
+    aggregating_factory->set_aggregate_invocations(aggregate_invocations);
+    aggregating_factory->set_sparse_indexed_frequencies(
+        sparse_indexed_frequencies);
+    aggregating_factory->set_module_filter(module_filter);
+  }
+  Service call_trace_service(session_trace_file_writer_factory.get());
   RpcServiceInstanceManager rpc_instance(&call_trace_service);
 
   // Get/set the instance id.
@@ -184,8 +335,10 @@ bool RunService(const base::CommandLine* cmd_line,
   base::FilePath trace_directory(cmd_line->GetSwitchValuePath("trace-dir"));
   if (trace_directory.empty())
     trace_directory = base::FilePath(L".");
-  if (!session_trace_file_writer_factory.SetTraceFileDirectory(trace_directory))
+  if (!session_trace_file_writer_factory->SetTraceFileDirectory(
+          trace_directory)) {
     return false;
+  }
 
   // Setup the buffer size.
   std::wstring buffer_size_str(cmd_line->GetSwitchValueNative("buffer-size"));
@@ -198,9 +351,30 @@ bool RunService(const base::CommandLine* cmd_line,
     call_trace_service.set_buffer_size_in_bytes(num);
   }
 
+  if (cmd_line->HasSwitch("compress"))
+    session_trace_file_writer_factory->set_compress_segments(true);
+  if (cmd_line->HasSwitch("index-segments"))
+    session_trace_file_writer_factory->set_index_segments(true);
+  if (!stream_pipe_name.empty()) {
+    session_trace_file_writer_factory->set_stream_pipe_name(stream_pipe_name);
+    call_trace_service.set_max_session_pool_bytes(
+        static_cast<uint64_t>(kDefaultStreamSessionMemory) * 1024 * 1024);
+  }
+
+  if (cmd_line->HasSwitch("large-pages"))
+    call_trace_service.set_use_large_pages(true);
+
   if (cmd_line->HasSwitch("enable-exits")) {
     call_trace_service.set_flags(TRACE_FLAG_ENTER | TRACE_FLAG_EXIT);
   }
+  if (cmd_line->HasSwitch("compact-records")) {
+    call_trace_service.set_flags(call_trace_service.flags() |
+                                 TRACE_FLAG_COMPACT_RECORDS);
+  }
+  if (cmd_line->HasSwitch("filter-repeated-entries")) {
+    call_trace_service.set_flags(call_trace_service.flags() |
+                                 TRACE_FLAG_FILTER_REPEATED_ENTRIES);
+  }
 
   // Setup the number of incremental buffers
   std::wstring buffers_str(
@@ -215,6 +389,20 @@ bool RunService(const base::CommandLine* cmd_line,
     call_trace_service.set_num_incremental_buffers(num);
   }
 
+  // Setup the memory cap of each session.
+  std::wstring max_memory_str(
+      cmd_line->GetSwitchValueNative("max-session-memory"));
+  if (!max_memory_str.empty()) {
+    int num = 0;
+    if (!base::StringToInt(max_memory_str, &num) || num < 1) {
+      LOG(ERROR) << "Invalid maximum session memory: " << max_memory_str
+                 << ".";
+      return false;
+    }
+    call_trace_service.set_max_session_pool_bytes(
+        static_cast<uint64_t>(num) * 1024 * 1024);
+  }
+
   if (app_cmd_line->get() != NULL) {
     // Run the service in non-blocking mode.
     call_trace_service.Start(true);
@@ -247,6 +435,46 @@ bool RunService(const base::CommandLine* cmd_line,
   return true;
 }
 
+bool RunCollector(const base::CommandLine* cmd_line) {
+  DCHECK(cmd_line != NULL);
+
+  base::FilePath pipe_name(cmd_line->GetSwitchValuePath("pipe-name"));
+  if (pipe_name.empty()) {
+    LOG(ERROR) << "The pipe on which to collect must be given.";
+    return false;
+  }
+  base::FilePath trace_directory(cmd_line->GetSwitchValuePath("trace-dir"));
+  if (trace_directory.empty())
+    trace_directory = base::FilePath(L".");
+
+  base::win::ScopedHandle stop_event(::CreateEvent(NULL, TRUE, FALSE, NULL));
+  if (!stop_event.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create event: " << ::common::LogWe(error) << ".";
+    return false;
+  }
+  collector_stop_event = stop_event.Get();
+
+  TraceStreamCollector collector(pipe_name, trace_directory);
+  if (!collector.Start())
+    return false;
+
+  // Collect until interrupted.
+  if (!SetConsoleCtrlHandler(&OnCollectorConsoleCtrl, TRUE)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to register shutdown handler: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+  ::WaitForSingleObject(stop_event.Get(), INFINITE);
+  SetConsoleCtrlHandler(&OnCollectorConsoleCtrl, FALSE);
+
+  collector.Stop();
+  LOG(INFO) << "Collected " << collector.num_trace_files()
+            << " trace file(s).";
+  return true;
+}
+
 bool SpawnService(const base::CommandLine* cmd_line) {
   // Get the path to ourselves.
   base::FilePath self_path;
@@ -335,6 +563,46 @@ bool StopService(const base::StringPiece16& instance_id) {
   return true;
 }
 
+bool PrintStatistics(const base::StringPiece16& instance_id) {
+  std::wstring protocol;
+  std::wstring endpoint;
+
+  ::GetSyzygyCallTraceRpcProtocol(&protocol);
+  ::GetSyzygyCallTraceRpcEndpoint(instance_id, &endpoint);
+
+  handle_t binding = NULL;
+  if (!CreateRpcBinding(protocol, endpoint, &binding)) {
+    LOG(ERROR) << "Failed to connect to call trace logging service.";
+    return false;
+  }
+
+  unsigned long num_sessions = 0;
+  CallTraceSessionStatistics* statistics = NULL;
+  if (!InvokeRpc(CallTraceClient_GetStatistics, binding, &num_sessions,
+                 &statistics).succeeded()) {
+    LOG(ERROR) << "Failed to get call trace logging service statistics.";
+    return false;
+  }
+
+  std::cout << num_sessions << " session(s).\n";
+  for (unsigned long i = 0; i < num_sessions; ++i) {
+    const CallTraceSessionStatistics& stats = statistics[i];
+    std::cout << "PID " << stats.process_id << ":\n"
+              << "  buffers allocated:     " << stats.buffers_allocated
+              << " (" << stats.bytes_allocated << " bytes)\n"
+              << "  buffers pending write: " << stats.buffers_pending_write
+              << "\n"
+              << "  buffer waits:          " << stats.buffer_waits
+              << " (" << stats.buffer_wait_time_us << " us)\n"
+              << "  bytes written:         " << stats.bytes_written << "\n"
+              << "  writer lag:            " << stats.average_writer_lag_us
+              << " us average, " << stats.max_writer_lag_us << " us max\n";
+  }
+  midl_user_free(statistics);
+
+  return true;
+}
+
 extern "C" int main(int argc, char** argv) {
   base::AtExitManager at_exit_manager;
   base::CommandLine::Init(argc, argv);
@@ -378,6 +646,11 @@ extern "C" int main(int argc, char** argv) {
     return (GetInstanceId(cmd_line, &id) && StopService(id)) ? 0 : 1;
   }
 
+  if (base::LowerCaseEqualsASCII(cmd_line->GetArgs()[0], "statistics")) {
+    std::wstring id;
+    return (GetInstanceId(cmd_line, &id) && PrintStatistics(id)) ? 0 : 1;
+  }
+
   if (base::LowerCaseEqualsASCII(cmd_line->GetArgs()[0], "start")) {
     return RunService(cmd_line, &app_command_line) ? 0 : 1;
   }
@@ -386,6 +659,10 @@ extern "C" int main(int argc, char** argv) {
     return SpawnService(cmd_line) ? 0 : 1;
   }
 
+  if (base::LowerCaseEqualsASCII(cmd_line->GetArgs()[0], "collect")) {
+    return RunCollector(cmd_line) ? 0 : 1;
+  }
+
   return Usage();
 }
 
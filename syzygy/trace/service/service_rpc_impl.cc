@@ -84,12 +84,32 @@ boolean CallTraceService_CloseSession(
   return true;
 }
 
+// RPC entrypoint for CallTraceService::OpenBufferExchange().
+boolean CallTraceService_OpenBufferExchange(
+    /* [in] */ SessionHandle session_handle,
+    /* [out] */ unsigned long* exchange_handle,
+    /* [out] */ unsigned long* event_handle) {
+  Service* instance = RpcServiceInstanceManager::GetInstance();
+  return instance->OpenBufferExchange(session_handle,
+                                      exchange_handle,
+                                      event_handle);
+}
+
 // RPC entrypoint for CallTraceControl::Stop().
 boolean CallTraceService_Stop(/* [in] */ handle_t /* binding */) {
   Service* instance = RpcServiceInstanceManager::GetInstance();
   return instance->RequestShutdown();
 }
 
+// RPC entrypoint for CallTraceControl::GetStatistics().
+boolean CallTraceService_GetStatistics(
+    /* [in] */ handle_t /* binding */,
+    /* [out] */ unsigned long* num_sessions,
+    /* [size_is][size_is][out] */ CallTraceSessionStatistics** statistics) {
+  Service* instance = RpcServiceInstanceManager::GetInstance();
+  return instance->GetStatistics(num_sessions, statistics);
+}
+
 // This callback is invoked if the RPC mechanism detects that a client
 // has ceased to exist, but the service still has resources allocated
 // on the client's behalf.
@@ -23,6 +23,7 @@
 #include "syzygy/trace/service/session.h"
 
 #include <time.h>
+#include <algorithm>
 #include <memory>
 
 #include "base/command_line.h"
@@ -50,15 +51,32 @@ std::ostream& operator << (std::ostream& stream, const Buffer::ID& buffer_id) {
                 << ", buffer_offset=0x" << std::hex << buffer_id.second;
 }
 
+// Folds a sample into a recent average, giving it a weight of 1/8.
+void UpdateAverage(base::TimeDelta sample, base::TimeDelta* average) {
+  DCHECK(average != NULL);
+  if (average->is_zero()) {
+    *average = sample;
+    return;
+  }
+  *average += (sample - *average) / 8;
+}
+
 }  // namespace
 
+const DWORD Session::kBufferExchangeDrainPeriodMs = 100;
+const size_t Session::kMaxIncrementalBuffersFactor = 8;
+
 Session::Session(Service* call_trace_service)
     : call_trace_service_(call_trace_service),
       is_closing_(false),
       buffer_consumer_(NULL),
       buffer_requests_waiting_for_recycle_(0),
       buffer_is_available_(&lock_),
+      bytes_allocated_(0),
+      buffer_waits_(0),
       buffer_id_(0),
+      buffer_exchange_(NULL),
+      buffer_exchange_wait_(NULL),
       input_error_already_logged_(false) {
   DCHECK(call_trace_service != NULL);
   ::memset(buffer_state_counts_, 0, sizeof(buffer_state_counts_));
@@ -75,6 +93,12 @@ Session::~Session() {
   DCHECK_EQ(buffers_.size(), buffer_state_counts_[Buffer::kAvailable]);
   DCHECK_EQ(0u, buffer_state_counts_[Buffer::kInUse]);
   DCHECK_EQ(0u, buffer_state_counts_[Buffer::kPendingWrite]);
+  DCHECK(buffer_exchange_wait_ == NULL);
+
+  if (buffer_exchange_ != NULL) {
+    ::UnmapViewOfFile(buffer_exchange_);
+    buffer_exchange_ = NULL;
+  }
 
   // Not strictly necessary, but let's make sure nothing refers to the
   // client buffers before we delete the underlying memory.
@@ -110,7 +134,12 @@ bool Session::Init(ProcessId client_process_id) {
 }
 
 bool Session::Close() {
+  // This has to happen before taking the locks, as a drain in progress
+  // will take them.
+  StopWaitingForBufferExchange();
+
   std::vector<Buffer*> buffers;
+  base::AutoLock exchange_lock(buffer_exchange_lock_);
   base::AutoLock lock(lock_);
 
   // It's possible that the service is being stopped just after this session
@@ -122,6 +151,10 @@ bool Session::Close() {
   // Otherwise the session is being asked to close for the first time.
   is_closing_ = true;
 
+  // The buffers queued in the buffer exchange are flushed first, as they
+  // were filled before those the client still holds.
+  FlushBufferExchangeUnlocked();
+
   // We'll reserve space for the worst case scenario buffer count.
   buffers.reserve(buffer_state_counts_[Buffer::kInUse] + 1);
 
@@ -147,6 +180,124 @@ bool Session::Close() {
   return true;
 }
 
+bool Session::OpenBufferExchange(HANDLE* client_exchange_handle,
+                                 HANDLE* client_event_handle) {
+  DCHECK(client_exchange_handle != NULL);
+  DCHECK(client_event_handle != NULL);
+
+  *client_exchange_handle = NULL;
+  *client_event_handle = NULL;
+
+  base::AutoLock exchange_lock(buffer_exchange_lock_);
+  base::AutoLock lock(lock_);
+
+  if (is_closing_) {
+    LOG(ERROR) << "Session is closing but someone is trying to open its "
+               << "buffer exchange.";
+    return false;
+  }
+
+  if (buffer_exchange_ != NULL) {
+    LOG(ERROR) << "The buffer exchange is already open.";
+    return false;
+  }
+
+  const size_t kExchangeSize = sizeof(trace::common::BufferExchange);
+  base::win::ScopedHandle exchange_handle(::CreateFileMapping(
+      NULL, NULL, PAGE_READWRITE, 0, kExchangeSize, NULL));
+  if (!exchange_handle.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to allocate buffer exchange: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  base::win::ScopedHandle event(::CreateEvent(NULL, FALSE, FALSE, NULL));
+  if (!event.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create buffer exchange event: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  if (!CopyBufferHandleToClient(client_.process_handle.Get(),
+                                exchange_handle.Get(),
+                                client_exchange_handle) ||
+      !CopyBufferHandleToClient(client_.process_handle.Get(),
+                                event.Get(),
+                                client_event_handle)) {
+    return false;
+  }
+
+  trace::common::BufferExchange* exchange =
+      reinterpret_cast<trace::common::BufferExchange*>(::MapViewOfFile(
+          exchange_handle.Get(), FILE_MAP_WRITE, 0, 0, kExchangeSize));
+  if (exchange == NULL) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to map buffer exchange: " << ::common::LogWe(error)
+               << ".";
+    return false;
+  }
+  exchange->free_buffers.Init();
+  exchange->full_buffers.Init();
+
+  buffer_exchange_handle_.Set(exchange_handle.Take());
+  buffer_exchange_ = exchange;
+  buffer_exchange_event_.Set(event.Take());
+
+  RestockBufferExchangeUnlocked();
+
+  // The wait fires whenever the client signals the event, and whenever the
+  // drain period elapses without it doing so. The latter picks up the
+  // buffers of clients that trace too little to cross the thresholds.
+  if (!::RegisterWaitForSingleObject(&buffer_exchange_wait_,
+                                     buffer_exchange_event_.Get(),
+                                     &Session::OnBufferExchangeSignaled,
+                                     this,
+                                     kBufferExchangeDrainPeriodMs,
+                                     WT_EXECUTEDEFAULT)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to wait for buffer exchange event: "
+               << ::common::LogWe(error) << ".";
+    buffer_exchange_wait_ = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+void Session::DrainBufferExchange() {
+  base::AutoLock exchange_lock(buffer_exchange_lock_);
+
+  trace::common::BufferExchange* exchange = NULL;
+  {
+    base::AutoLock lock(lock_);
+    exchange = buffer_exchange_;
+  }
+  if (exchange == NULL)
+    return;
+
+  // Bound the drain, so that a client that keeps queueing buffers can't
+  // monopolize the thread.
+  ::CallTraceBuffer call_trace_buffer = {};
+  for (size_t i = 0; i < trace::common::BufferRing::kCapacity &&
+           exchange->full_buffers.Pop(&call_trace_buffer); ++i) {
+    Buffer* buffer = NULL;
+    {
+      base::AutoLock lock(lock_);
+      buffer = FindExchangedBufferUnlocked(call_trace_buffer);
+    }
+
+    // This logs if anything goes wrong.
+    if (buffer != NULL)
+      ReturnBuffer(buffer);
+  }
+
+  base::AutoLock lock(lock_);
+  if (!is_closing_)
+    RestockBufferExchangeUnlocked();
+}
+
 bool Session::FindBuffer(CallTraceBuffer* call_trace_buffer,
                          Buffer** client_buffer) {
   DCHECK(call_trace_buffer != NULL);
@@ -179,6 +330,29 @@ bool Session::FindBuffer(CallTraceBuffer* call_trace_buffer,
   return true;
 }
 
+void Session::GetStatistics(::CallTraceSessionStatistics* statistics) {
+  DCHECK(statistics != NULL);
+  DCHECK(buffer_consumer_.get() != NULL);
+
+  // The consumer keeps its own books, and is queried first so as not to hold
+  // lock_ while doing so.
+  uint64_t bytes_written = buffer_consumer_->GetBytesWritten();
+
+  base::AutoLock lock(lock_);
+
+  ::memset(statistics, 0, sizeof(*statistics));
+  statistics->process_id = client_.process_id;
+  statistics->buffers_allocated = static_cast<unsigned long>(buffers_.size());
+  statistics->bytes_allocated = bytes_allocated_;
+  statistics->buffers_pending_write = static_cast<unsigned long>(
+      buffer_state_counts_[Buffer::kPendingWrite]);
+  statistics->buffer_waits = static_cast<unsigned long>(buffer_waits_);
+  statistics->buffer_wait_time_us = buffer_wait_time_.InMicroseconds();
+  statistics->bytes_written = bytes_written;
+  statistics->average_writer_lag_us = writer_lag_average_.InMicroseconds();
+  statistics->max_writer_lag_us = max_writer_lag_.InMicroseconds();
+}
+
 bool Session::GetNextBuffer(Buffer** out_buffer) {
   return GetBuffer(0, out_buffer);
 }
@@ -281,6 +455,21 @@ void Session::ChangeBufferState(BufferState new_state, Buffer* buffer) {
   DCHECK_EQ(static_cast<int>(new_state),
             (static_cast<int>(old_state) + 1) % Buffer::kBufferStateMax);
 
+  // Keep track of how quickly the client fills buffers, and of how long the
+  // writer takes to get through them.
+  if (new_state == Buffer::kPendingWrite) {
+    base::TimeTicks now = base::TimeTicks::Now();
+    if (!last_return_time_.is_null())
+      UpdateAverage(now - last_return_time_, &fill_interval_average_);
+    last_return_time_ = now;
+    buffer->pending_write_time = now;
+  } else if (old_state == Buffer::kPendingWrite) {
+    base::TimeDelta writer_lag =
+        base::TimeTicks::Now() - buffer->pending_write_time;
+    UpdateAverage(writer_lag, &writer_lag_average_);
+    max_writer_lag_ = std::max(max_writer_lag_, writer_lag);
+  }
+
   // Apply the state change.
   buffer->state = new_state;
   buffer_state_counts_[old_state]--;
@@ -342,7 +531,8 @@ bool Session::AllocateBufferPool(
 
   // Initialize the shared buffer pool.
   buffer_size = ::common::AlignUp(buffer_size, buffer_consumer_->block_size());
-  if (!pool->Init(this, num_buffers, buffer_size)) {
+  if (!pool->Init(this, num_buffers, buffer_size,
+                  call_trace_service_->use_large_pages())) {
     LOG(ERROR) << "Failed to initialize shared memory buffer.";
     return false;
   }
@@ -372,6 +562,7 @@ bool Session::AllocateBufferPool(
 
   // Save the shared memory block so that it's managed by the session.
   shared_memory_buffers_.push_back(pool.get());
+  bytes_allocated_ += static_cast<uint64_t>(num_buffers) * buffer_size;
   *out_pool = pool.release();
 
   return true;
@@ -435,6 +626,37 @@ bool Session::AllocateBufferForImmediateUse(size_t minimum_size,
   return true;
 }
 
+size_t Session::GetNumBuffersToAllocateUnlocked() const {
+  lock_.AssertAcquired();
+
+  size_t num_buffers = call_trace_service_->num_incremental_buffers();
+
+  // If the writer takes longer to get through a buffer than the client takes
+  // to fill one, grow the pool by as many buffers as the client fills in
+  // that time, so that it doesn't have to wait for them.
+  int64_t fill_interval_us = fill_interval_average_.InMicroseconds();
+  int64_t writer_lag_us = writer_lag_average_.InMicroseconds();
+  if (fill_interval_us > 0 && writer_lag_us > fill_interval_us) {
+    size_t buffers_per_lag =
+        static_cast<size_t>(writer_lag_us / fill_interval_us);
+    num_buffers = std::min(std::max(num_buffers, buffers_per_lag),
+                           num_buffers * kMaxIncrementalBuffersFactor);
+  }
+
+  uint64_t max_bytes = call_trace_service_->max_session_pool_bytes();
+  if (max_bytes != 0) {
+    size_t buffer_size = ::common::AlignUp(
+        call_trace_service_->buffer_size_in_bytes(),
+        buffer_consumer_->block_size());
+    uint64_t room =
+        bytes_allocated_ < max_bytes ? max_bytes - bytes_allocated_ : 0;
+    num_buffers = static_cast<size_t>(
+        std::min<uint64_t>(num_buffers, room / buffer_size));
+  }
+
+  return num_buffers;
+}
+
 bool Session::GetNextBufferUnlocked(Buffer** out_buffer) {
   DCHECK(out_buffer != NULL);
   lock_.AssertAcquired();
@@ -470,18 +692,36 @@ bool Session::GetNextBufferUnlocked(Buffer** out_buffer) {
           call_trace_service_->max_buffers_pending_write();
     }
 
+    // At its memory cap the pool can't grow, so any of the buffers pending
+    // write may be waited for. If there are none left to wait for, the
+    // request fails rather than waiting on the client to return buffers.
+    size_t num_buffers = GetNumBuffersToAllocateUnlocked();
+    if (num_buffers == 0) {
+      buffers_force_recyclable = buffer_state_counts_[Buffer::kPendingWrite];
+      if (buffer_requests_waiting_for_recycle_ >= buffers_force_recyclable) {
+        LOG(ERROR) << "Buffer pool of PID=" << client_.process_id
+                   << " is at its cap of "
+                   << call_trace_service_->max_session_pool_bytes()
+                   << " bytes.";
+        return false;
+      }
+    }
+
     // If there's still room to do so, wait rather than allocating immediately.
     // This will either force us to wait until a buffer has been written and
     // recycled, or if the request volume is high enough we'll likely be
     // satisfied by an allocation.
     if (buffer_requests_waiting_for_recycle_ < buffers_force_recyclable) {
       ++buffer_requests_waiting_for_recycle_;
+      ++buffer_waits_;
       OnWaitingForBufferToBeRecycled();  // Unittest hook.
+      base::TimeTicks wait_start = base::TimeTicks::Now();
       buffer_is_available_.Wait();
+      buffer_wait_time_ += base::TimeTicks::Now() - wait_start;
       --buffer_requests_waiting_for_recycle_;
     } else {
       // Otherwise, force an allocation.
-      if (!AllocateBuffers(call_trace_service_->num_incremental_buffers(),
+      if (!AllocateBuffers(num_buffers,
                            call_trace_service_->buffer_size_in_bytes())) {
         return false;
       }
@@ -537,6 +777,7 @@ bool Session::DestroySingletonBuffer(Buffer* buffer) {
 
   // Remove the buffer from our buffer statistics.
   buffer_state_counts_[Buffer::kPendingWrite]--;
+  bytes_allocated_ -= buffer->mapping_size;
   DCHECK(BufferBookkeepingIsConsistent());
 
   // Finally, delete the pool. This will clean up the buffer.
@@ -619,6 +860,115 @@ bool Session::CreateProcessEndedEvent(Buffer** buffer) {
   return true;
 }
 
+// static
+VOID CALLBACK Session::OnBufferExchangeSignaled(PVOID session,
+                                                BOOLEAN /* timed_out */) {
+  DCHECK(session != NULL);
+  reinterpret_cast<Session*>(session)->DrainBufferExchange();
+}
+
+void Session::StopWaitingForBufferExchange() {
+  HANDLE wait = NULL;
+  {
+    base::AutoLock lock(lock_);
+    std::swap(wait, buffer_exchange_wait_);
+  }
+  if (wait == NULL)
+    return;
+
+  if (!::UnregisterWaitEx(wait, INVALID_HANDLE_VALUE)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to stop waiting for buffer exchange event: "
+               << ::common::LogWe(error) << ".";
+  }
+}
+
+void Session::RestockBufferExchangeUnlocked() {
+  DCHECK(buffer_exchange_ != NULL);
+  lock_.AssertAcquired();
+
+  size_t target = std::min(trace::common::BufferExchange::kFreeBufferTarget,
+                           call_trace_service_->num_incremental_buffers());
+  while (buffer_exchange_->free_buffers.size() < target) {
+    if (buffers_available_.empty()) {
+      // Past the back-pressure threshold, the client is left to fall back
+      // to ExchangeBuffer, which waits for buffers to be recycled.
+      if (buffer_state_counts_[Buffer::kPendingWrite] >
+          call_trace_service_->max_buffers_pending_write()) {
+        return;
+      }
+      size_t num_buffers = GetNumBuffersToAllocateUnlocked();
+      if (num_buffers == 0 ||
+          !AllocateBuffers(num_buffers,
+                           call_trace_service_->buffer_size_in_bytes())) {
+        return;
+      }
+    }
+    DCHECK(!buffers_available_.empty());
+
+    Buffer* buffer = buffers_available_.front();
+    if (!buffer_exchange_->free_buffers.Push(*buffer))
+      return;
+    buffers_available_.pop_front();
+    ChangeBufferState(Buffer::kInUse, buffer);
+  }
+}
+
+void Session::FlushBufferExchangeUnlocked() {
+  buffer_exchange_lock_.AssertAcquired();
+  lock_.AssertAcquired();
+  DCHECK(is_closing_);
+
+  if (buffer_exchange_ == NULL)
+    return;
+
+  // Fresh buffers would otherwise be written out as invalid segments. They
+  // go back to being available, which isn't a state transition that can be
+  // made through ChangeBufferState.
+  ::CallTraceBuffer call_trace_buffer = {};
+  for (size_t i = 0; i < trace::common::BufferRing::kCapacity &&
+           buffer_exchange_->free_buffers.Pop(&call_trace_buffer); ++i) {
+    Buffer* buffer = FindExchangedBufferUnlocked(call_trace_buffer);
+    if (buffer == NULL)
+      continue;
+
+    buffer->state = Buffer::kAvailable;
+    buffer_state_counts_[Buffer::kInUse]--;
+    buffer_state_counts_[Buffer::kAvailable]++;
+    buffers_available_.push_back(buffer);
+  }
+
+  for (size_t i = 0; i < trace::common::BufferRing::kCapacity &&
+           buffer_exchange_->full_buffers.Pop(&call_trace_buffer); ++i) {
+    Buffer* buffer = FindExchangedBufferUnlocked(call_trace_buffer);
+    if (buffer == NULL)
+      continue;
+
+    ChangeBufferState(Buffer::kPendingWrite, buffer);
+    buffer_consumer_->ConsumeBuffer(buffer);
+  }
+
+  DCHECK(BufferBookkeepingIsConsistent());
+}
+
+Buffer* Session::FindExchangedBufferUnlocked(
+    const ::CallTraceBuffer& call_trace_buffer) {
+  lock_.AssertAcquired();
+
+  Buffer::ID buffer_id = Buffer::GetID(call_trace_buffer);
+  BufferMap::iterator iter = buffers_.find(buffer_id);
+  if (iter == buffers_.end() || iter->second->state != Buffer::kInUse) {
+    if (!input_error_already_logged_) {
+      LOG(ERROR) << "Received exchanged buffer not in use for this session "
+                 << "[pid=" << client_.process_id << ", " << buffer_id << "].";
+      input_error_already_logged_ = true;
+    }
+    return NULL;
+  }
+
+  return iter->second;
+}
+
 bool Session::BufferBookkeepingIsConsistent() const {
   lock_.AssertAcquired();
 
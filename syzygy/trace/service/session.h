@@ -26,7 +26,9 @@
 #include "base/process/process.h"
 #include "base/synchronization/condition_variable.h"
 #include "base/synchronization/lock.h"
+#include "base/time/time.h"
 #include "base/win/scoped_handle.h"
+#include "syzygy/trace/common/buffer_exchange.h"
 #include "syzygy/trace/service/buffer_consumer.h"
 #include "syzygy/trace/service/buffer_pool.h"
 #include "syzygy/trace/service/process_info.h"
@@ -90,12 +92,33 @@ class Session : public base::RefCountedThreadSafe<Session> {
   // @returns true on success, false otherwise.
   bool RecycleBuffer(Buffer* buffer);
 
+  // Opens the buffer exchange through which the client can trade buffers
+  // without calling into the service, and stocks it with fresh buffers. The
+  // exchange is drained whenever the client signals it, and periodically.
+  // @param client_exchange_handle receives the handle of the shared memory
+  //     holding the exchange, valid in the client process.
+  // @param client_event_handle receives the handle of the event waking the
+  //     session, valid in the client process.
+  // @returns true on success, false otherwise.
+  bool OpenBufferExchange(HANDLE* client_exchange_handle,
+                          HANDLE* client_event_handle);
+
+  // Hands the full buffers queued in the buffer exchange to the buffer
+  // consumer, in the order the client queued them, then restocks the
+  // exchange with fresh buffers. This does nothing if the exchange isn't
+  // open.
+  void DrainBufferExchange();
+
   // Locates the local record of the given call trace buffer.  The session
   // retains ownership of the buffer object, it MUST not be deleted by the
   // caller.
   bool FindBuffer(::CallTraceBuffer* call_trace_buffer,
                   Buffer** client_buffer);
 
+  // Gets the buffer statistics of this session.
+  // @param statistics receives the statistics.
+  void GetStatistics(::CallTraceSessionStatistics* statistics);
+
   // Returns the process id of the client process.
   ProcessId client_process_id() const { return client_.process_id; }
 
@@ -173,6 +196,18 @@ class Session : public base::RefCountedThreadSafe<Session> {
   // @pre minimum_size must be bigger than the common buffer allocation size.
   bool AllocateBufferForImmediateUse(size_t minimum_size, Buffer** out_buffer);
 
+  // The most buffers a session allocates at once, as a multiple of the
+  // service's number of incremental buffers.
+  static const size_t kMaxIncrementalBuffersFactor;
+
+  // Gets the number of buffers by which to grow the pool. This covers the
+  // buffers the client fills while the writer catches up on one, as
+  // observed recently, and is limited by the session's memory cap.
+  // @returns the number of buffers to allocate, or zero if the pool can't
+  //     grow.
+  // @pre Under lock_.
+  size_t GetNumBuffersToAllocateUnlocked() const;
+
   // A private implementation of GetNextBuffer, but which assumes the lock has
   // already been acquired.
   // @param buffer will be populated with a pointer to the buffer to be provided
@@ -209,6 +244,42 @@ class Session : public base::RefCountedThreadSafe<Session> {
   // @pre Under lock_.
   bool CreateProcessEndedEvent(Buffer** buffer);
 
+  // The period at which the buffer exchange is drained if the client doesn't
+  // signal it.
+  static const DWORD kBufferExchangeDrainPeriodMs;
+
+  // Invoked on a thread pool thread when the client signals the buffer
+  // exchange, or when the drain period elapses.
+  // @param session the session whose exchange is to be drained.
+  // @param timed_out true if the drain period elapsed.
+  static VOID CALLBACK OnBufferExchangeSignaled(PVOID session,
+                                                BOOLEAN timed_out);
+
+  // Stops waiting for the client to signal the buffer exchange. This blocks
+  // until any drain in progress on the thread pool has completed.
+  // @pre Not under lock_ or buffer_exchange_lock_.
+  void StopWaitingForBufferExchange();
+
+  // Pushes fresh buffers to the free ring of the buffer exchange, until it's
+  // stocked or the session would have to exceed its back-pressure threshold.
+  // @pre Under lock_, and the buffer exchange is open.
+  void RestockBufferExchangeUnlocked();
+
+  // Empties the buffer exchange when the session closes. Fresh buffers the
+  // client hasn't taken are made available again, and full buffers are
+  // handed to the buffer consumer in the order the client queued them.
+  // @pre Under buffer_exchange_lock_ and lock_.
+  void FlushBufferExchangeUnlocked();
+
+  // Looks up the in-use buffer described by a descriptor popped from the
+  // buffer exchange.
+  // @param call_trace_buffer the descriptor written by the client.
+  // @returns the buffer, or NULL if the descriptor doesn't describe a buffer
+  //     in use by the client.
+  // @pre Under lock_.
+  Buffer* FindExchangedBufferUnlocked(
+      const ::CallTraceBuffer& call_trace_buffer);
+
   // Returns true if the buffer book-keeping is self-consistent.
   // @pre Under lock_.
   bool BufferBookkeepingIsConsistent() const;
@@ -249,6 +320,25 @@ class Session : public base::RefCountedThreadSafe<Session> {
   // This condition variable is used to indicate that a buffer is available.
   base::ConditionVariable buffer_is_available_;  // Under lock_.
 
+  // @name Statistics of the buffer pool. These drive its growth, and are
+  //     reported by GetStatistics.
+  // @{
+  // The total size of the buffers allocated.
+  uint64_t bytes_allocated_;  // Under lock_.
+  // The number of times, and total time, buffer requests waited for buffers
+  // to be recycled.
+  size_t buffer_waits_;  // Under lock_.
+  base::TimeDelta buffer_wait_time_;  // Under lock_.
+  // When a buffer was last returned, and the recent average time between
+  // returns.
+  base::TimeTicks last_return_time_;  // Under lock_.
+  base::TimeDelta fill_interval_average_;  // Under lock_.
+  // The recent average and the maximum time from a buffer being returned to
+  // it being recycled.
+  base::TimeDelta writer_lag_average_;  // Under lock_.
+  base::TimeDelta max_writer_lag_;  // Under lock_.
+  // @}
+
   // This is currently only used to allocate unique IDs to buffers allocated
   // after the session closes.
   // TODO(rogerm): extend this to all buffers.
@@ -258,6 +348,20 @@ class Session : public base::RefCountedThreadSafe<Session> {
   // state.
   base::Lock lock_;
 
+  // The shared memory holding the buffer exchange, and its local mapping.
+  // These are set once when the exchange is opened.
+  base::win::ScopedHandle buffer_exchange_handle_;
+  trace::common::BufferExchange* buffer_exchange_;  // Under lock_.
+
+  // The event through which the client wakes the session, and the wait
+  // draining the exchange when it's signaled.
+  base::win::ScopedHandle buffer_exchange_event_;
+  HANDLE buffer_exchange_wait_;  // Under lock_.
+
+  // Serializes the draining of the buffer exchange, so that full buffers are
+  // consumed in the order they were queued. This is acquired before lock_.
+  base::Lock buffer_exchange_lock_;
+
   // Tracks whether or not invalid input errors have already been logged.
   // When an error of this type occurs, there will typically be numerous
   // follow-on occurrences that we don't want to log.
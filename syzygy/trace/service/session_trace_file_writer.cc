@@ -21,6 +21,7 @@
 
 #include "base/bind.h"
 #include "base/files/file_util.h"
+#include "syzygy/common/com_utils.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
 #include "syzygy/trace/service/buffer_pool.h"
 #include "syzygy/trace/service/mapped_buffer.h"
@@ -29,17 +30,83 @@
 namespace trace {
 namespace service {
 
+struct SessionTraceFileWriter::PendingWrite {
+  PendingWrite(SessionTraceFileWriter* writer, Buffer* buffer)
+      : writer(writer),
+        session(buffer->session),
+        buffer(buffer),
+        mapped_buffer(buffer),
+        sequence(0),
+        bytes_to_write(0),
+        issued(false) {
+    ::memset(&overlapped, 0, sizeof(overlapped));
+  }
+
+  // Identifies this write in the completion port.
+  OVERLAPPED overlapped;
+
+  // These are kept alive until the buffer is recycled, as they would be by
+  // a task posted to message_loop_.
+  scoped_refptr<SessionTraceFileWriter> writer;
+  scoped_refptr<Session> session;
+
+  Buffer* buffer;
+  MappedBuffer mapped_buffer;
+
+  // The order in which the buffer was consumed.
+  uint64_t sequence;
+
+  // The number of bytes to write, or zero if the buffer is dropped.
+  size_t bytes_to_write;
+
+  // Whether the write to the trace file has been issued.
+  bool issued;
+};
+
 SessionTraceFileWriter::SessionTraceFileWriter(
     base::MessageLoop* message_loop, const base::FilePath& trace_directory)
     : message_loop_(message_loop),
+      writer_pool_(NULL),
+      next_sequence_(0),
+      next_reserved_sequence_(0),
       trace_file_path_(trace_directory) {
   DCHECK(message_loop != NULL);
   DCHECK(!trace_directory.empty());
 }
 
+SessionTraceFileWriter::SessionTraceFileWriter(
+    TraceFileWriterPool* writer_pool, const base::FilePath& trace_directory)
+    : message_loop_(NULL),
+      writer_pool_(writer_pool),
+      next_sequence_(0),
+      next_reserved_sequence_(0),
+      trace_file_path_(trace_directory) {
+  DCHECK(writer_pool != NULL);
+  DCHECK(!trace_directory.empty());
+}
+
+SessionTraceFileWriter::~SessionTraceFileWriter() {
+  // Every buffer write holds a reference to this writer, so all of them have
+  // landed and the segment index is complete.
+  if (writer_.handle() != NULL && !writer_.Close()) {
+    LOG(ERROR) << "Failed to close trace file '" << writer_.path().value()
+               << "'.";
+  }
+}
+
 bool SessionTraceFileWriter::Open(Session* session) {
   DCHECK(session != NULL);
 
+  // Streamed trace files are written by the collector, which names them.
+  if (!stream_pipe_name_.empty()) {
+    DCHECK(message_loop_ != NULL);
+    if (!writer_.OpenPipe(stream_pipe_name_) ||
+        !writer_.WriteHeader(session->client_info())) {
+      return false;
+    }
+    return true;
+  }
+
   if (!base::CreateDirectory(trace_file_path_)) {
     LOG(ERROR) << "Failed to create trace directory: '"
                << trace_file_path_.value() << "'.";
@@ -53,6 +120,15 @@ bool SessionTraceFileWriter::Open(Session* session) {
   trace_file_path_ = trace_file_path_.Append(basename);
 
   // Open the trace file and write the header.
+  if (writer_pool_ != NULL) {
+    if (!writer_.OpenOverlapped(trace_file_path_) ||
+        !writer_.WriteHeader(session->client_info()) ||
+        !writer_pool_->RegisterIOHandler(writer_.handle(), this)) {
+      return false;
+    }
+    return true;
+  }
+
   if (!writer_.Open(trace_file_path_) ||
       !writer_.WriteHeader(session->client_info())) {
     return false;
@@ -68,8 +144,26 @@ bool SessionTraceFileWriter::Close(Session* /* session */) {
 bool SessionTraceFileWriter::ConsumeBuffer(Buffer* buffer) {
   DCHECK(buffer != NULL);
   DCHECK(buffer->session != NULL);
-  DCHECK(message_loop_ != NULL);
 
+  if (writer_pool_ != NULL) {
+    PendingWrite* write = new PendingWrite(this, buffer);
+
+    // Buffers are sequenced as they're consumed, so that they land in the
+    // trace file in that order whichever pool threads compress and write
+    // them. Posting under the lock keeps the sequence free of holes. Even
+    // dropped buffers are released on the pool, as the session may be
+    // holding its lock while calling us.
+    base::AutoLock lock(lock_);
+    write->sequence = next_sequence_;
+    if (!writer_pool_->Post(this, &write->overlapped)) {
+      delete write;
+      return false;
+    }
+    ++next_sequence_;
+    return true;
+  }
+
+  DCHECK(message_loop_ != NULL);
   message_loop_->PostTask(FROM_HERE,
                           base::Bind(&SessionTraceFileWriter::WriteBuffer,
                                      this,
@@ -83,6 +177,11 @@ size_t SessionTraceFileWriter::block_size() const {
   return writer_.block_size();
 }
 
+uint64_t SessionTraceFileWriter::GetBytesWritten() {
+  base::AutoLock lock(lock_);
+  return writer_.next_offset();
+}
+
 void SessionTraceFileWriter::WriteBuffer(scoped_refptr<Session> session,
                                          Buffer* buffer) {
   DCHECK(session != NULL);
@@ -95,9 +194,16 @@ void SessionTraceFileWriter::WriteBuffer(scoped_refptr<Session> session,
   if (!mapped_buffer.Map())
     return;
 
+  ProcessBuffer(mapped_buffer.data(), buffer->buffer_size);
+  if (writer_.compress_segments())
+    writer_.CompressRecord(mapped_buffer.data(), buffer->buffer_size);
+
   // We deliberately ignore the return status. However, this will log if
   // anything goes wrong.
-  writer_.WriteRecord(mapped_buffer.data(), buffer->buffer_size);
+  {
+    base::AutoLock lock(lock_);
+    writer_.WriteRecord(mapped_buffer.data(), buffer->buffer_size);
+  }
 
   // It's entirely possible for this buffer to be handed out to another client
   // and for the service to be forcibly shutdown before the client has had a
@@ -111,5 +217,100 @@ void SessionTraceFileWriter::WriteBuffer(scoped_refptr<Session> session,
   session->RecycleBuffer(buffer);
 }
 
+void SessionTraceFileWriter::OnIOCompleted(OVERLAPPED* overlapped,
+                                           DWORD bytes_transferred,
+                                           DWORD error) {
+  DCHECK(overlapped != NULL);
+
+  PendingWrite* write = CONTAINING_RECORD(overlapped, PendingWrite, overlapped);
+  DCHECK_EQ(this, write->writer.get());
+
+  if (write->issued) {
+    if (error != ERROR_SUCCESS || bytes_transferred != write->bytes_to_write) {
+      LOG(ERROR) << "Failed writing to '" << writer_.path().value()
+                 << "': " << ::common::LogWe(error) << ".";
+    }
+    FinishWrite(write);
+    return;
+  }
+
+  // This is the request posted by ConsumeBuffer. Buffers are compressed
+  // concurrently, but the ranges of the trace file they're written to are
+  // reserved in sequence. We deliberately ignore the status of the
+  // reservation. However, this will log if anything goes wrong.
+  if (write->mapped_buffer.Map()) {
+    ProcessBuffer(write->mapped_buffer.data(), write->buffer->buffer_size);
+    if (writer_.compress_segments()) {
+      writer_.CompressRecord(write->mapped_buffer.data(),
+                             write->buffer->buffer_size);
+    }
+  }
+
+  std::vector<PendingWrite*> writes;
+  {
+    base::AutoLock lock(lock_);
+    ready_writes_[write->sequence] = write;
+    while (!ready_writes_.empty() &&
+           ready_writes_.begin()->first == next_reserved_sequence_) {
+      PendingWrite* ready_write = ready_writes_.begin()->second;
+      ready_writes_.erase(ready_writes_.begin());
+      ++next_reserved_sequence_;
+
+      uint64_t offset = 0;
+      if (ready_write->mapped_buffer.IsMapped() &&
+          writer_.ReserveRecord(ready_write->mapped_buffer.data(),
+                                ready_write->buffer->buffer_size,
+                                &ready_write->bytes_to_write, &offset)) {
+        ready_write->overlapped.Offset = static_cast<DWORD>(offset);
+        ready_write->overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      }
+      writes.push_back(ready_write);
+    }
+  }
+
+  // The writes are issued outside of the lock, as extending the trace file
+  // may make them synchronous.
+  for (PendingWrite* ready_write : writes)
+    IssueWrite(ready_write);
+}
+
+void SessionTraceFileWriter::IssueWrite(PendingWrite* write) {
+  DCHECK(write != NULL);
+  DCHECK(!write->issued);
+
+  // Issue the write, whose completion is dispatched back to OnIOCompleted,
+  // unless there's nothing to write.
+  if (write->bytes_to_write != 0) {
+    write->issued = true;
+    if (::WriteFile(writer_.handle(), write->mapped_buffer.data(),
+                    write->bytes_to_write, NULL, &write->overlapped) ||
+        ::GetLastError() == ERROR_IO_PENDING) {
+      return;
+    }
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed writing to '" << writer_.path().value()
+               << "': " << ::common::LogWe(error) << ".";
+  }
+
+  FinishWrite(write);
+}
+
+void SessionTraceFileWriter::FinishWrite(PendingWrite* write) {
+  DCHECK(write != NULL);
+  DCHECK_EQ(Buffer::kPendingWrite, write->buffer->state);
+
+  // As in WriteBuffer, buffers that couldn't be mapped aren't recycled.
+  if (write->mapped_buffer.IsMapped()) {
+    // Clear the buffer, for the same reason as in WriteBuffer.
+    ::memset(write->mapped_buffer.data(), 0,
+             sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader));
+    write->mapped_buffer.Unmap();
+    write->session->RecycleBuffer(write->buffer);
+  }
+
+  // This may release the last reference to this writer.
+  delete write;
+}
+
 }  // namespace service
 }  // namespace trace
@@ -19,11 +19,16 @@
 #ifndef SYZYGY_TRACE_SERVICE_SESSION_TRACE_FILE_WRITER_H_
 #define SYZYGY_TRACE_SERVICE_SESSION_TRACE_FILE_WRITER_H_
 
+#include <map>
+
 #include "base/files/file_path.h"
+#include "base/logging.h"
+#include "base/synchronization/lock.h"
 #include "base/threading/thread.h"
 #include "base/win/scoped_handle.h"
 #include "syzygy/trace/service/buffer_consumer.h"
 #include "syzygy/trace/service/trace_file_writer.h"
+#include "syzygy/trace/service/trace_file_writer_pool.h"
 
 namespace trace {
 namespace service {
@@ -34,7 +39,8 @@ class SessionTraceFileWriterFactory;
 
 // This class implements the interface the buffer consumer thread uses to
 // process incoming buffers.
-class SessionTraceFileWriter : public BufferConsumer {
+class SessionTraceFileWriter : public BufferConsumer,
+                               public TraceFileWriterPool::IOHandler {
  public:
   // Construct a SessionTraceFileWriter instance.
   // @param message_loop The message loop on which this writer instance will
@@ -45,6 +51,18 @@ class SessionTraceFileWriter : public BufferConsumer {
   SessionTraceFileWriter(base::MessageLoop* message_loop,
                          const base::FilePath& trace_directory);
 
+  // Construct a SessionTraceFileWriter instance that writes buffers with
+  // overlapped I/O, on the threads of a writer pool. Buffers are written to
+  // the trace file in the order in which they're consumed, whatever order
+  // their writes complete in.
+  // @param writer_pool The pool on which this writer instance will consume
+  //     buffers. The writer instance does NOT take ownership of the pool. The
+  //     pool must outlive the writer instance.
+  // @param trace_directory The directory into which this writer instance will
+  //     write the trace file.
+  SessionTraceFileWriter(TraceFileWriterPool* writer_pool,
+                         const base::FilePath& trace_directory);
+
   // Initialize this trace file writer.
   // @name BufferConsumer implementation.
   // @{
@@ -52,20 +70,98 @@ class SessionTraceFileWriter : public BufferConsumer {
   bool Close(Session* session) override;
   bool ConsumeBuffer(Buffer* buffer) override;
   size_t block_size() const override;
+  uint64_t GetBytesWritten() override;
   // @}
 
+  // Sets whether buffers are compressed before being written. This must be
+  // called before Open.
+  // @param compress_segments true to compress buffers.
+  void set_compress_segments(bool compress_segments) {
+    writer_.set_compress_segments(compress_segments);
+  }
+
+  // Sets whether an index of the segments is appended to the trace file once
+  // all buffers are written. This must be called before Open.
+  // @param index_segments true to index the segments.
+  void set_index_segments(bool index_segments) {
+    writer_.set_index_segments(index_segments);
+  }
+
+  // Sets the named pipe of a trace collector to stream the trace file to,
+  // rather than writing it to the trace directory. This must be called before
+  // Open, and only on writers that consume buffers on a message loop, as the
+  // buffers must be streamed in order.
+  // @param pipe_name the name of the collector's pipe.
+  void set_stream_pipe_name(const base::FilePath& pipe_name) {
+    DCHECK(message_loop_ != NULL);
+    stream_pipe_name_ = pipe_name;
+  }
+
  protected:
+  // Closes the trace file, appending the segment index if need be.
+  ~SessionTraceFileWriter() override;
+
+  // The state of a buffer being written through the writer pool.
+  struct PendingWrite;
+
   // Commit a trace buffer to disk. This will be called on message_loop_.
   void WriteBuffer(scoped_refptr<Session>, Buffer* buffer);
 
-  // The message loop on which this trace file writer will do IO.
+  // Processes the records of a buffer in place before it's written. This is
+  // called on the thread writing the buffer, which may be any thread of the
+  // writer pool, and does nothing by default.
+  // @param data the mapped buffer.
+  // @param length the size of the buffer.
+  virtual void ProcessBuffer(void* data, size_t length) {}
+
+  // @name TraceFileWriterPool::IOHandler implementation.
+  // @{
+  void OnIOCompleted(OVERLAPPED* overlapped,
+                     DWORD bytes_transferred,
+                     DWORD error) override;
+  // @}
+
+  // Issues the write of a buffer whose range of the trace file is reserved.
+  // @param write the write of the buffer.
+  void IssueWrite(PendingWrite* write);
+
+  // Releases a buffer once it has been written, or dropped.
+  // @param write the write of the buffer, which is deleted.
+  void FinishWrite(PendingWrite* write);
+
+  // The message loop on which this trace file writer will do IO, or NULL if
+  // it uses writer_pool_.
   base::MessageLoop* const message_loop_;
 
+  // The pool on which this trace file writer will do IO, or NULL if it uses
+  // message_loop_.
+  TraceFileWriterPool* const writer_pool_;
+
+  // Protects the reservation of records in writer_ when it's used from
+  // several threads at once, and the sequencing state below. This also
+  // protects the offset of writer_ from GetBytesWritten.
+  base::Lock lock_;
+
+  // @name Sequencing of the buffers written through writer_pool_.
+  // @{
+  // The sequence of the next buffer to be consumed.
+  uint64_t next_sequence_;
+  // The sequence of the next buffer whose record is to be reserved.
+  uint64_t next_reserved_sequence_;
+  // The buffers ready to be reserved, keyed by sequence, that are waiting
+  // on buffers consumed before them.
+  std::map<uint64_t, PendingWrite*> ready_writes_;
+  // @}
+
   // The name of the trace file. Note that we initialize this to the trace
   // directory on construction and calculate the final trace file path on
   // Open().
   base::FilePath trace_file_path_;
 
+  // The named pipe to which the trace file is streamed, or empty if it's
+  // written to trace_file_path_.
+  base::FilePath stream_pipe_name_;
+
   // This is used for committing actual buffers to disk.
   TraceFileWriter writer_;
 
@@ -23,11 +23,25 @@ namespace service {
 
 SessionTraceFileWriterFactory::SessionTraceFileWriterFactory(
     base::MessageLoop* message_loop)
-    : message_loop_(message_loop), trace_file_directory_(L".") {
+    : message_loop_(message_loop),
+      writer_pool_(NULL),
+      trace_file_directory_(L"."),
+      compress_segments_(false),
+      index_segments_(false) {
   DCHECK(message_loop != NULL);
   DCHECK_EQ(base::MessageLoop::TYPE_IO, message_loop->type());
 }
 
+SessionTraceFileWriterFactory::SessionTraceFileWriterFactory(
+    TraceFileWriterPool* writer_pool)
+    : message_loop_(NULL),
+      writer_pool_(writer_pool),
+      trace_file_directory_(L"."),
+      compress_segments_(false),
+      index_segments_(false) {
+  DCHECK(writer_pool != NULL);
+}
+
 bool SessionTraceFileWriterFactory::SetTraceFileDirectory(
     const base::FilePath& path) {
   DCHECK(!path.empty());
@@ -44,10 +58,21 @@ bool SessionTraceFileWriterFactory::SetTraceFileDirectory(
 bool SessionTraceFileWriterFactory::CreateConsumer(
     scoped_refptr<BufferConsumer>* consumer) {
   DCHECK(consumer != NULL);
-  DCHECK(message_loop_ != NULL);
 
   // Allocate a new trace file writer.
-  *consumer = new SessionTraceFileWriter(message_loop_, trace_file_directory_);
+  scoped_refptr<SessionTraceFileWriter> writer;
+  if (writer_pool_ != NULL) {
+    writer = new SessionTraceFileWriter(writer_pool_, trace_file_directory_);
+  } else {
+    DCHECK(message_loop_ != NULL);
+    writer = new SessionTraceFileWriter(message_loop_, trace_file_directory_);
+  }
+  writer->set_compress_segments(compress_segments_);
+  writer->set_index_segments(index_segments_);
+  if (!stream_pipe_name_.empty())
+    writer->set_stream_pipe_name(stream_pipe_name_);
+
+  *consumer = writer;
   return true;
 }
 
@@ -21,6 +21,7 @@
 #include <set>
 
 #include "base/files/file_path.h"
+#include "base/logging.h"
 #include "base/synchronization/lock.h"
 #include "base/win/scoped_handle.h"
 #include "syzygy/trace/service/buffer_consumer.h"
@@ -32,6 +33,7 @@ namespace trace {
 namespace service {
 
 class SessionTraceFileWriter;
+class TraceFileWriterPool;
 
 // This class creates manages buffer consumer instances for a call trace
 // service instance.
@@ -44,6 +46,14 @@ class SessionTraceFileWriterFactory : public BufferConsumerFactory {
   //     must outlive the factory instance.
   explicit SessionTraceFileWriterFactory(base::MessageLoop* message_loop);
 
+  // construct a SessionTraceFileWriterFactory instance whose writers use
+  // overlapped I/O.
+  // @param writer_pool The pool on which SessionTraceFileWriter instances
+  //     created by this factory will consume buffers. The factory instance
+  //     does NOT take ownership of the writer_pool. The writer_pool must
+  //     outlive the factory instance.
+  explicit SessionTraceFileWriterFactory(TraceFileWriterPool* writer_pool);
+
   // @name BufferConsumerFactory implementation.
   // @{
   virtual bool CreateConsumer(scoped_refptr<BufferConsumer>* consumer) override;
@@ -53,16 +63,57 @@ class SessionTraceFileWriterFactory : public BufferConsumerFactory {
   // file writers will output trace files.
   bool SetTraceFileDirectory(const base::FilePath& path);
 
+  // Sets whether all subsequently created trace file writers compress the
+  // segments of their trace files.
+  void set_compress_segments(bool compress_segments) {
+    compress_segments_ = compress_segments;
+  }
+
+  // Sets whether all subsequently created trace file writers append an index
+  // of the segments to their trace files.
+  void set_index_segments(bool index_segments) {
+    index_segments_ = index_segments;
+  }
+
+  // Sets the named pipe of the trace collector to which all subsequently
+  // created trace file writers stream their trace files, rather than writing
+  // them to the trace file directory. This is only supported by factories
+  // whose writers use a message loop.
+  // @param pipe_name the name of the collector's pipe, or empty to write
+  //     trace files to the trace file directory.
+  void set_stream_pipe_name(const base::FilePath& pipe_name) {
+    DCHECK(message_loop_ != NULL);
+    stream_pipe_name_ = pipe_name;
+  }
+
   // Get the message loop the trace file writers should use for IO.
   base::MessageLoop* message_loop() { return message_loop_; }
 
+  // Get the writer pool the trace file writers should use for IO.
+  TraceFileWriterPool* writer_pool() { return writer_pool_; }
+
  protected:
-  // The message loop the trace file writers should use for IO.
+  // The message loop the trace file writers should use for IO, or NULL if
+  // they use writer_pool_.
   base::MessageLoop* const message_loop_;
 
+  // The writer pool the trace file writers should use for IO, or NULL if
+  // they use message_loop_.
+  TraceFileWriterPool* const writer_pool_;
+
   // The directory into which trace file writers will write.
   base::FilePath trace_file_directory_;
 
+  // Whether trace file writers compress the segments of their trace files.
+  bool compress_segments_;
+
+  // Whether trace file writers index the segments of their trace files.
+  bool index_segments_;
+
+  // The named pipe to which trace file writers stream their trace files, or
+  // empty if they write them to trace_file_directory_.
+  base::FilePath stream_pipe_name_;
+
   // The set of currently active buffer consumer objects. Protected by lock_.
   std::set<scoped_refptr<BufferConsumer>> active_consumers_;
 
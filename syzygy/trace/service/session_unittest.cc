@@ -411,6 +411,62 @@ TEST_F(SessionTest, ReturnBufferWorksAfterSessionClose) {
   session->AllowBuffersToBeRecycled(9999);
 }
 
+TEST_F(SessionTest, BufferExchangeWorks) {
+  ASSERT_TRUE(call_trace_service_.Start(true));
+
+  TestSessionPtr session = call_trace_service_.CreateTestSession();
+  ASSERT_TRUE(session != NULL);
+
+  // The test session shares its own handles with the "client".
+  HANDLE exchange_handle = NULL;
+  HANDLE event_handle = NULL;
+  ASSERT_TRUE(session->OpenBufferExchange(&exchange_handle, &event_handle));
+  ASSERT_TRUE(exchange_handle != NULL);
+  ASSERT_TRUE(event_handle != NULL);
+  ASSERT_FALSE(session->OpenBufferExchange(&exchange_handle, &event_handle));
+
+  trace::common::BufferExchange* exchange =
+      reinterpret_cast<trace::common::BufferExchange*>(::MapViewOfFile(
+          exchange_handle, FILE_MAP_WRITE, 0, 0,
+          sizeof(trace::common::BufferExchange)));
+  ASSERT_TRUE(exchange != NULL);
+
+  // The free ring is stocked with as many buffers as are allocated at once.
+  EXPECT_EQ(2u, exchange->free_buffers.size());
+  EXPECT_EQ(0u, exchange->full_buffers.size());
+
+  ::CallTraceBuffer call_trace_buffer = {};
+  ASSERT_TRUE(exchange->free_buffers.Pop(&call_trace_buffer));
+  Buffer* buffer1 = NULL;
+  ASSERT_TRUE(session->FindBuffer(&call_trace_buffer, &buffer1));
+  EXPECT_EQ(Buffer::kInUse, buffer1->state);
+
+  // Queueing the buffer hands it over for writing once the exchange is
+  // drained, and the free ring is then restocked.
+  ASSERT_TRUE(exchange->full_buffers.Push(call_trace_buffer));
+  ASSERT_TRUE(::SetEvent(event_handle));
+  session->DrainBufferExchange();
+  EXPECT_EQ(0u, exchange->full_buffers.size());
+  EXPECT_EQ(Buffer::kPendingWrite, buffer1->state);
+  EXPECT_EQ(2u, exchange->free_buffers.size());
+
+  // Closing the session takes back the fresh buffers, rather than writing
+  // them out.
+  ASSERT_TRUE(exchange->free_buffers.Pop(&call_trace_buffer));
+  Buffer* buffer2 = NULL;
+  ASSERT_TRUE(session->FindBuffer(&call_trace_buffer, &buffer2));
+  ASSERT_TRUE(exchange->full_buffers.Push(call_trace_buffer));
+  ASSERT_TRUE(session->Close());
+  EXPECT_EQ(0u, exchange->free_buffers.size());
+  EXPECT_EQ(0u, exchange->full_buffers.size());
+  EXPECT_EQ(Buffer::kPendingWrite, buffer2->state);
+
+  ASSERT_TRUE(::UnmapViewOfFile(exchange));
+
+  // Let's allow the outstanding buffers to be written.
+  session->AllowBuffersToBeRecycled(9999);
+}
+
 TEST_F(SessionTest, BackPressureWorks) {
   // Configure things so that back-pressure will be easily forced.
   call_trace_service_.set_max_buffers_pending_write(1);
@@ -537,6 +593,52 @@ TEST_F(SessionTest, BackPressureIsLimited) {
   session->AllowBuffersToBeRecycled(9999);
 }
 
+TEST_F(SessionTest, PoolGrowthIsCapped) {
+  // Allow for exactly two buffers.
+  call_trace_service_.set_max_session_pool_bytes(2 * 8192);
+  ASSERT_TRUE(call_trace_service_.Start(true));
+
+  TestSessionPtr session = call_trace_service_.CreateTestSession();
+  ASSERT_TRUE(session != NULL);
+  ASSERT_EQ(0u, 8192 % session->buffer_consumer()->block_size());
+
+  Buffer* buffer1 = NULL;
+  ASSERT_TRUE(session->GetNextBuffer(&buffer1));
+  Buffer* buffer2 = NULL;
+  ASSERT_TRUE(session->GetNextBuffer(&buffer2));
+
+  // With no buffers to wait for, a request beyond the cap fails.
+  Buffer* buffer3 = NULL;
+  ASSERT_FALSE(session->GetNextBuffer(&buffer3));
+
+  // Otherwise it waits for a buffer to be recycled.
+  ASSERT_TRUE(session->ReturnBuffer(buffer1));
+  session->ClearWaitingForBufferToBeRecycledState();
+  bool result3 = false;
+  base::Closure buffer_getter3 = base::Bind(
+      &GetNextBuffer, session, &buffer3, &result3);
+  worker1_.message_loop()->PostTask(FROM_HERE, buffer_getter3);
+  session->PauseUntilWaitingForBufferToBeRecycled();
+  session->AllowBuffersToBeRecycled(1);
+  worker1_.Stop();
+  ASSERT_TRUE(result3);
+  ASSERT_EQ(buffer1, buffer3);
+
+  ::CallTraceSessionStatistics statistics = {};
+  session->GetStatistics(&statistics);
+  EXPECT_EQ(session->client_process_id(), statistics.process_id);
+  EXPECT_EQ(2u, statistics.buffers_allocated);
+  EXPECT_EQ(2u * 8192, statistics.bytes_allocated);
+  EXPECT_EQ(0u, statistics.buffers_pending_write);
+  EXPECT_EQ(1u, statistics.buffer_waits);
+  EXPECT_LE(statistics.average_writer_lag_us, statistics.max_writer_lag_us);
+  EXPECT_LT(0u, statistics.bytes_written);
+
+  ASSERT_TRUE(session->ReturnBuffer(buffer2));
+  ASSERT_TRUE(session->ReturnBuffer(buffer3));
+  session->AllowBuffersToBeRecycled(9999);
+}
+
 TEST_F(SessionTest, LargeBufferRequestAvoidsBackPressure) {
   // Configure things so that back-pressure will be easily forced.
   call_trace_service_.set_max_buffers_pending_write(1);
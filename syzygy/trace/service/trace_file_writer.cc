@@ -21,6 +21,8 @@
 #include "syzygy/common/buffer_writer.h"
 #include "syzygy/common/com_utils.h"
 #include "syzygy/common/path_util.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/core/zstream.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
 
 namespace trace {
@@ -29,6 +31,7 @@ namespace service {
 namespace {
 
 bool OpenTraceFile(const base::FilePath& file_path,
+                   DWORD flags,
                    base::win::ScopedHandle* file_handle) {
   DCHECK(!file_path.empty());
   DCHECK(file_handle != NULL);
@@ -40,7 +43,7 @@ bool OpenTraceFile(const base::FilePath& file_path,
                    FILE_SHARE_DELETE | FILE_SHARE_READ,
                    NULL, /* lpSecurityAttributes */
                    CREATE_ALWAYS,
-                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING,
+                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | flags,
                    NULL /* hTemplateFile */));
   if (!new_file_handle.IsValid()) {
     DWORD error = ::GetLastError();
@@ -81,9 +84,20 @@ bool GetBlockSize(const base::FilePath& path, size_t* block_size) {
   return true;
 }
 
+// How long to wait for an instance of a collector's pipe to be free.
+const DWORD kPipeBusyTimeoutMs = 10 * 1000;
+
 }  // namespace
 
-TraceFileWriter::TraceFileWriter() : block_size_(0) {
+const size_t TraceFileWriter::kStreamBlockSize = 4096;
+
+TraceFileWriter::TraceFileWriter()
+    : block_size_(0),
+      overlapped_(false),
+      stream_(false),
+      next_offset_(0),
+      compress_segments_(false),
+      index_segments_(false) {
 }
 
 TraceFileWriter::~TraceFileWriter() {
@@ -112,9 +126,17 @@ base::FilePath TraceFileWriter::GenerateTraceFileBaseName(
 }
 
 bool TraceFileWriter::Open(const base::FilePath& path) {
+  return OpenWithFlags(path, 0);
+}
+
+bool TraceFileWriter::OpenOverlapped(const base::FilePath& path) {
+  return OpenWithFlags(path, FILE_FLAG_OVERLAPPED);
+}
+
+bool TraceFileWriter::OpenWithFlags(const base::FilePath& path, DWORD flags) {
   // Open the trace file.
   base::win::ScopedHandle temp_handle;
-  if (!OpenTraceFile(path, &temp_handle)) {
+  if (!OpenTraceFile(path, flags, &temp_handle)) {
     LOG(ERROR) << "Failed to open trace file: '"
                << path_.value() << "'.";
     return false;
@@ -130,6 +152,48 @@ bool TraceFileWriter::Open(const base::FilePath& path) {
   path_ = path;
   handle_.Set(temp_handle.Take());
   block_size_ = block_size;
+  overlapped_ = (flags & FILE_FLAG_OVERLAPPED) != 0;
+  stream_ = false;
+  next_offset_ = 0;
+
+  return true;
+}
+
+bool TraceFileWriter::OpenPipe(const base::FilePath& pipe_name) {
+  DCHECK(!pipe_name.empty());
+
+  // Every instance of the pipe may be connected to already, in which case we
+  // wait for one to be freed.
+  base::win::ScopedHandle temp_handle;
+  while (true) {
+    temp_handle.Set(::CreateFile(pipe_name.value().c_str(),
+                                 GENERIC_WRITE,
+                                 0, /* dwShareMode */
+                                 NULL, /* lpSecurityAttributes */
+                                 OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 NULL /* hTemplateFile */));
+    if (temp_handle.IsValid())
+      break;
+
+    DWORD error = ::GetLastError();
+    if (error == ERROR_PIPE_BUSY &&
+        ::WaitNamedPipe(pipe_name.value().c_str(), kPipeBusyTimeoutMs)) {
+      continue;
+    }
+    if (error == ERROR_PIPE_BUSY)
+      error = ::GetLastError();
+    LOG(ERROR) << "Failed to open trace collector pipe '"
+               << pipe_name.value() << "': " << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  path_ = pipe_name;
+  handle_.Set(temp_handle.Take());
+  block_size_ = kStreamBlockSize;
+  overlapped_ = false;
+  stream_ = true;
+  next_offset_ = 0;
 
   return true;
 }
@@ -176,17 +240,20 @@ bool TraceFileWriter::WriteHeader(const ProcessInfo& process_info) {
   header->system_info = process_info.system_info;
   header->memory_status = process_info.memory_status;
   trace::common::GetClockInfo(&header->clock_info);
+  header->flags = 0;
+  if (compress_segments_)
+    header->flags |= TraceFileHeader::kCompressedSegments;
+  if (index_segments_)
+    header->flags |= TraceFileHeader::kSegmentIndex;
 
   // Align the header buffer up to the block size.
   writer.Align(block_size_);
 
   // Commit the header page to disk.
-  DWORD bytes_written = 0;
-  if (!::WriteFile(handle_.Get(), &buffer[0], buffer.size(), &bytes_written,
-                   NULL) || bytes_written != buffer.size() ) {
-    DWORD error = ::GetLastError();
-    LOG(ERROR) << "Failed writing trace file header: " << ::common::LogWe(error)
-               << ".";
+  uint64_t offset = next_offset_;
+  next_offset_ += buffer.size();
+  if (!WriteBlocks(&buffer[0], buffer.size(), offset)) {
+    LOG(ERROR) << "Failed writing trace file header.";
     return false;
   }
 
@@ -194,29 +261,61 @@ bool TraceFileWriter::WriteHeader(const ProcessInfo& process_info) {
 }
 
 bool TraceFileWriter::WriteRecord(const void* data, size_t length) {
+  size_t bytes_to_write = 0;
+  uint64_t offset = 0;
+  if (!ReserveRecord(data, length, &bytes_to_write, &offset))
+    return false;
+  if (bytes_to_write == 0)
+    return true;
+
+  // Commit the buffer to disk.
+  return WriteBlocks(data, bytes_to_write, offset);
+}
+
+bool TraceFileWriter::ReserveRecord(const void* data,
+                                    size_t length,
+                                    size_t* bytes_to_write,
+                                    uint64_t* offset) {
   DCHECK(data != NULL);
+  DCHECK(bytes_to_write != NULL);
+  DCHECK(offset != NULL);
 
-  const size_t kHeaderLength =
-      sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+  *bytes_to_write = 0;
+  *offset = next_offset_;
 
-  if (length < kHeaderLength) {
+  if (length < sizeof(RecordPrefix)) {
     LOG(ERROR) << "Dropped buffer: too short.";
     return false;
   }
 
-  // We currently can only handle records that contain a TraceFileSegmentHeader.
+  // We currently can only handle records that contain a TraceFileSegmentHeader
+  // or, if compression is enabled, a TraceFileCompressedSegmentHeader.
   const RecordPrefix* record = reinterpret_cast<const RecordPrefix*>(data);
-  if (record->type != TraceFileSegmentHeader::kTypeId ||
-      record->size != sizeof(TraceFileSegmentHeader) ||
+  size_t segment_header_size = sizeof(TraceFileSegmentHeader);
+  if (compress_segments_ &&
+      record->type == TraceFileCompressedSegmentHeader::kTypeId) {
+    segment_header_size = sizeof(TraceFileCompressedSegmentHeader);
+  } else if (record->type != TraceFileSegmentHeader::kTypeId) {
+    LOG(ERROR) << "Dropped buffer: invalid RecordPrefix.";
+    return false;
+  }
+  if (record->size != segment_header_size ||
       record->version.hi != TRACE_VERSION_HI ||
       record->version.lo != TRACE_VERSION_LO) {
     LOG(ERROR) << "Dropped buffer: invalid RecordPrefix.";
     return false;
   }
 
+  const size_t kHeaderLength = sizeof(RecordPrefix) + segment_header_size;
+  if (length < kHeaderLength) {
+    LOG(ERROR) << "Dropped buffer: too short.";
+    return false;
+  }
+
   // Let's not trust the client to stop playing with the buffer while
   // we're writing. Whatever the length is now, is what we'll use. If the
-  // segment itself is empty we simply skip writing the buffer.
+  // segment itself is empty we simply skip writing the buffer. Both kinds of
+  // segment headers start with the same fields.
   const TraceFileSegmentHeader* header =
       reinterpret_cast<const TraceFileSegmentHeader*>(record + 1);
   size_t segment_length = header->segment_length;
@@ -226,26 +325,229 @@ bool TraceFileWriter::WriteRecord(const void* data, size_t length) {
   }
 
   // Figure out the total size that we'll write to disk.
-  size_t bytes_to_write = ::common::AlignUp(kHeaderLength + segment_length,
-                                            block_size_);
+  size_t record_size = ::common::AlignUp(kHeaderLength + segment_length,
+                                         block_size_);
 
   // Ensure that the total number of bytes to write does not exceed the
   // maximum record length.
-  if (bytes_to_write > length) {
+  if (record_size > length) {
     LOG(ERROR) << "Dropped buffer: bytes written exceeds buffer size.";
     return false;
   }
 
-  // Commit the buffer to disk.
-  // TODO(rogerm): Use overlapped I/O.
-  DCHECK_LT(0u, bytes_to_write);
+  DCHECK_LT(0u, record_size);
+  *bytes_to_write = record_size;
+
+  if (index_segments_) {
+    TraceFileSegmentIndexEntry entry = {};
+    if (record->type == TraceFileCompressedSegmentHeader::kTypeId) {
+      const TraceFileCompressedSegmentHeader* compressed_header =
+          reinterpret_cast<const TraceFileCompressedSegmentHeader*>(header);
+      entry.first_timestamp = compressed_header->first_timestamp;
+      entry.last_timestamp = compressed_header->last_timestamp;
+      entry.record_types = compressed_header->record_types;
+    } else {
+      SummarizeSegment(header + 1, segment_length, &entry);
+    }
+    entry.offset = next_offset_;
+    entry.thread_id = header->thread_id;
+    segment_index_.push_back(entry);
+  }
+
+  next_offset_ += record_size;
+
+  return true;
+}
+
+bool TraceFileWriter::CompressRecord(void* data, size_t length) const {
+  DCHECK(data != NULL);
+  DCHECK(compress_segments_);
+
+  const size_t kHeaderLength =
+      sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+  const size_t kCompressedHeaderLength =
+      sizeof(RecordPrefix) + sizeof(TraceFileCompressedSegmentHeader);
+  if (length < kCompressedHeaderLength)
+    return false;
+
+  // Records that aren't valid segments are left for ReserveRecord to drop.
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data);
+  if (record->type != TraceFileSegmentHeader::kTypeId ||
+      record->size != sizeof(TraceFileSegmentHeader)) {
+    return false;
+  }
+  const TraceFileSegmentHeader* header =
+      reinterpret_cast<const TraceFileSegmentHeader*>(record + 1);
+  TraceFileSegmentHeader segment_header = *header;
+  if (segment_header.segment_length == 0 ||
+      segment_header.segment_length > length - kHeaderLength) {
+    return false;
+  }
+
+  // Compress for speed, as this is done for every buffer.
+  std::vector<uint8_t> compressed;
+  compressed.reserve(segment_header.segment_length);
+  core::ByteVectorOutStream out_stream(&compressed);
+  core::ZOutStream zip_stream(&out_stream);
+  if (!zip_stream.Init(core::ZOutStream::kZBestSpeed) ||
+      !zip_stream.Write(segment_header.segment_length,
+                        reinterpret_cast<const core::Byte*>(header + 1)) ||
+      !zip_stream.Flush()) {
+    LOG(ERROR) << "Failed to compress segment.";
+    return false;
+  }
+
+  // Only keep the compressed segment if it saves blocks on disk.
+  size_t uncompressed_size = ::common::AlignUp(
+      kHeaderLength + segment_header.segment_length, block_size_);
+  size_t compressed_size = ::common::AlignUp(
+      kCompressedHeaderLength + compressed.size(), block_size_);
+  if (compressed_size >= uncompressed_size)
+    return false;
+
+  // The compressed record is shorter, so it fits in place.
+  // The summary of the records is kept in the header, for the segment index.
+  TraceFileSegmentIndexEntry summary = {};
+  SummarizeSegment(header + 1, segment_header.segment_length, &summary);
+  TraceFileCompressedSegmentHeader compressed_header = {};
+  compressed_header.thread_id = segment_header.thread_id;
+  compressed_header.segment_length = compressed.size();
+  compressed_header.uncompressed_length = segment_header.segment_length;
+  compressed_header.first_timestamp = summary.first_timestamp;
+  compressed_header.last_timestamp = summary.last_timestamp;
+  compressed_header.record_types = summary.record_types;
+  record->type = TraceFileCompressedSegmentHeader::kTypeId;
+  record->size = sizeof(compressed_header);
+  ::memcpy(record + 1, &compressed_header, sizeof(compressed_header));
+  ::memcpy(reinterpret_cast<uint8_t*>(data) + kCompressedHeaderLength,
+           compressed.data(), compressed.size());
+
+  return true;
+}
+
+void TraceFileWriter::SummarizeSegment(const void* records,
+                                       size_t length,
+                                       TraceFileSegmentIndexEntry* entry) {
+  DCHECK(records != NULL);
+  DCHECK(entry != NULL);
+
+  entry->first_timestamp = 0;
+  entry->last_timestamp = 0;
+  entry->record_types = 0;
+
+  // The client may still be writing to the buffer, so the prefixes are
+  // copied before being used.
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(records);
+  size_t offset = 0;
+  bool first = true;
+  while (length - offset >= sizeof(RecordPrefix)) {
+    RecordPrefix prefix = {};
+    ::memcpy(&prefix, data + offset, sizeof(prefix));
+    if (prefix.size > length - offset - sizeof(prefix))
+      break;
+
+    // Records aren't quite in timestamp order, so this keeps the range they
+    // span.
+    if (first || prefix.timestamp < entry->first_timestamp)
+      entry->first_timestamp = prefix.timestamp;
+    if (first || prefix.timestamp > entry->last_timestamp)
+      entry->last_timestamp = prefix.timestamp;
+    first = false;
+    entry->record_types |=
+        TraceFileSegmentIndexEntry::GetRecordTypeBit(prefix.type);
+    offset += sizeof(prefix) + prefix.size;
+  }
+}
+
+bool TraceFileWriter::WriteSegmentIndex() {
+  // The index is laid out as a record, followed by the trailer at the end of
+  // its last block.
+  const size_t kIndexLength = sizeof(RecordPrefix) +
+      offsetof(TraceFileSegmentIndex, entries) +
+      segment_index_.size() * sizeof(TraceFileSegmentIndexEntry);
+  size_t record_size = ::common::AlignUp(
+      kIndexLength + sizeof(TraceFileSegmentIndexTrailer), block_size_);
+  std::vector<uint8_t> buffer(record_size, 0);
+
+  RecordPrefix* prefix = reinterpret_cast<RecordPrefix*>(buffer.data());
+  prefix->timestamp = trace::common::GetTsc();
+  prefix->size = record_size - sizeof(RecordPrefix);
+  prefix->type = TraceFileSegmentIndex::kTypeId;
+  prefix->version.hi = TRACE_VERSION_HI;
+  prefix->version.lo = TRACE_VERSION_LO;
+
+  TraceFileSegmentIndex* index =
+      reinterpret_cast<TraceFileSegmentIndex*>(prefix + 1);
+  index->num_entries = segment_index_.size();
+  if (!segment_index_.empty()) {
+    ::memcpy(index->entries, segment_index_.data(),
+             segment_index_.size() * sizeof(TraceFileSegmentIndexEntry));
+  }
+
+  TraceFileSegmentIndexTrailer* trailer =
+      reinterpret_cast<TraceFileSegmentIndexTrailer*>(
+          buffer.data() + record_size - sizeof(TraceFileSegmentIndexTrailer));
+  ::memcpy(&trailer->signature,
+           &TraceFileSegmentIndexTrailer::kSignatureValue,
+           sizeof(trailer->signature));
+  trailer->index_offset = next_offset_;
+
+  uint64_t offset = next_offset_;
+  next_offset_ += record_size;
+  if (!WriteBlocks(buffer.data(), buffer.size(), offset)) {
+    LOG(ERROR) << "Failed writing trace file segment index.";
+    return false;
+  }
+
+  return true;
+}
+
+bool TraceFileWriter::WriteBlocks(const void* data,
+                                  size_t length,
+                                  uint64_t offset) {
+  DCHECK(data != NULL);
+  DCHECK_EQ(0u, length % block_size_);
+  DCHECK_EQ(0u, offset % block_size_);
+
+  // Pipes have no offset, and are written in order.
   DWORD bytes_written = 0;
-  if (!::WriteFile(handle_.Get(),
-                   record,
-                   bytes_to_write,
-                   &bytes_written,
-                   NULL) ||
-      bytes_written != bytes_to_write) {
+  if (stream_) {
+    if (!::WriteFile(handle_.Get(), data, length, &bytes_written, NULL) ||
+        bytes_written != length) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Failed streaming to '" << path_.value()
+                 << "': " << ::common::LogWe(error) << ".";
+      return false;
+    }
+    return true;
+  }
+
+  // An overlapped write needs an event to wait on. Setting its low bit keeps
+  // the completion from being queued to the completion port the handle may
+  // be associated with. Synchronous handles simply honor the offset.
+  base::win::ScopedHandle event;
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  if (overlapped_) {
+    event.Set(::CreateEvent(NULL, TRUE, FALSE, NULL));
+    if (!event.IsValid()) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Failed to create event: " << ::common::LogWe(error)
+                 << ".";
+      return false;
+    }
+    overlapped.hEvent = reinterpret_cast<HANDLE>(
+        reinterpret_cast<DWORD_PTR>(event.Get()) | 1);
+  }
+
+  BOOL written = ::WriteFile(handle_.Get(), data, length, &bytes_written,
+                             &overlapped);
+  if (!written && ::GetLastError() == ERROR_IO_PENDING) {
+    written = ::GetOverlappedResult(handle_.Get(), &overlapped, &bytes_written,
+                                    TRUE);
+  }
+  if (!written || bytes_written != length) {
     DWORD error = ::GetLastError();
     LOG(ERROR) << "Failed writing to '" << path_.value()
                << "': " << ::common::LogWe(error) << ".";
@@ -256,12 +558,24 @@ bool TraceFileWriter::WriteRecord(const void* data, size_t length) {
 }
 
 bool TraceFileWriter::Close() {
+  bool success = true;
+  if (index_segments_ && !WriteSegmentIndex())
+    success = false;
+
+  // Wait for the collector to have read the whole stream.
+  if (stream_ && !::FlushFileBuffers(handle_.Get())) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to flush '" << path_.value()
+               << "': " << ::common::LogWe(error) << ".";
+    success = false;
+  }
+
   if (::CloseHandle(handle_.Take()) == 0) {
     DWORD error = ::GetLastError();
     LOG(ERROR) << "CloseHandle failed: " << ::common::LogWe(error) << ".";
     return false;
   }
-  return true;
+  return success;
 }
 
 }  // namespace service
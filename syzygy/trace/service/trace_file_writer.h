@@ -35,12 +35,23 @@
 //
 //   if (!w.Close())
 //     ...
+//
+// If index_segments() is true, Close first appends an index of the segments
+// written to the trace file, so that a parser may skip the segments it isn't
+// interested in.
+//
+// A trace file may also be streamed to a TraceStreamCollector, possibly on
+// another machine, by opening its named pipe with OpenPipe rather than Open.
+// The stream is laid out exactly as the trace file would be.
 
 #ifndef SYZYGY_TRACE_SERVICE_TRACE_FILE_WRITER_H_
 #define SYZYGY_TRACE_SERVICE_TRACE_FILE_WRITER_H_
 
+#include <vector>
+
 #include "base/files/file_path.h"
 #include "base/win/scoped_handle.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
 #include "syzygy/trace/service/process_info.h"
 
 namespace trace {
@@ -69,6 +80,22 @@ class TraceFileWriter {
   // @returns true on success, false otherwise.
   bool Open(const base::FilePath& path);
 
+  // Opens a trace file for overlapped I/O at the given path. WriteHeader and
+  // WriteRecord still write synchronously, but records may also be written
+  // asynchronously through ReserveRecord and handle().
+  // @param path The path of the trace file to write.
+  // @returns true on success, false otherwise.
+  bool OpenOverlapped(const base::FilePath& path);
+
+  // Opens the named pipe of a trace collector, to which the trace file is
+  // streamed. Records are then written synchronously, and in the order in
+  // which they're reserved. This waits for an instance of the pipe to be
+  // free if the collector is busy.
+  // @param pipe_name The name of the pipe, of the form
+  //     \\server\pipe\name.
+  // @returns true on success, false otherwise.
+  bool OpenPipe(const base::FilePath& pipe_name);
+
   // Writes the header to the trace file. A trace file is associated with a
   // single running process, so we require a populated process-info struct.
   // @param process_info Information about the process to which this trace file
@@ -79,14 +106,42 @@ class TraceFileWriter {
   // Writes a record of data to disk.
   // @param data The record to be written. This must contain a RecordPrefix.
   //     This currently only supports records that contain a
-  //     TraceFileSegmenHeader.
+  //     TraceFileSegmenHeader, or a TraceFileCompressedSegmentHeader if
+  //     compress_segments() is true.
   // @param length The maximum length of continuous data that may be
   //     contained in the record. The actual length is stored in the header, but
   //     this is necessary to ensure that the header is valid.
   // @returns true on success, false otherwise.
   bool WriteRecord(const void* data, size_t length);
 
-  // Closes the trace file.
+  // Compresses a record in place, if compression saves space on disk. This
+  // turns a segment into a compressed segment that WriteRecord and
+  // ReserveRecord accept in its stead. This doesn't change the state of the
+  // writer, and may be called on several threads at once.
+  // @param data The record to compress. See WriteRecord.
+  // @param length The maximum length of the record. See WriteRecord.
+  // @returns true if the record was compressed, false if it was left as is.
+  // @pre compress_segments() is true.
+  bool CompressRecord(void* data, size_t length) const;
+
+  // Validates a record and reserves the range of the trace file it will be
+  // written to. Records are laid out in the order in which they're reserved,
+  // whatever order the writes to the reserved ranges complete in.
+  // @param data The record to be written. See WriteRecord.
+  // @param length The maximum length of the record. See WriteRecord.
+  // @param bytes_to_write Receives the number of bytes to write, a multiple of
+  //     the block size. This is zero for empty records, for which nothing is
+  //     reserved.
+  // @param offset Receives the offset in the trace file at which to write.
+  // @returns true on success, false if the record is invalid.
+  bool ReserveRecord(const void* data,
+                     size_t length,
+                     size_t* bytes_to_write,
+                     uint64_t* offset);
+
+  // Closes the trace file, after writing its segment index if
+  // index_segments() is true. All the records reserved must have been
+  // written.
   // @returns true on success, false otherwise.
   // @note If this is not called manually the trace-file will close itself when
   //     the writer goes out of scope.
@@ -100,7 +155,70 @@ class TraceFileWriter {
   // @note This is only valid after Open has returned successfully.
   size_t block_size() const { return block_size_; }
 
+  // @name Whether segments may be compressed. This must be set before the
+  //     header is written, which records it.
+  // @{
+  bool compress_segments() const { return compress_segments_; }
+  void set_compress_segments(bool compress_segments) {
+    compress_segments_ = compress_segments;
+  }
+  // @}
+
+  // @name Whether a segment index is written as the trace file is closed.
+  //     This must be set before the header is written, which records it.
+  // @{
+  bool index_segments() const { return index_segments_; }
+  void set_index_segments(bool index_segments) {
+    index_segments_ = index_segments;
+  }
+  // @}
+
+  // @returns the index entries of the segments reserved so far.
+  const std::vector<TraceFileSegmentIndexEntry>& segment_index() const {
+    return segment_index_;
+  }
+
+  // Summarizes the records of an uncompressed segment for the segment index.
+  // This doesn't fill in the offset and thread of the entry.
+  // @param records the records of the segment.
+  // @param length the length of the segment. Records that overrun it are
+  //     ignored.
+  // @param entry receives the summary.
+  static void SummarizeSegment(const void* records,
+                               size_t length,
+                               TraceFileSegmentIndexEntry* entry);
+
+  // @returns the number of bytes of the trace file written or reserved so
+  //     far, including its header.
+  uint64_t next_offset() const { return next_offset_; }
+
+  // @returns the handle to the trace file.
+  // @note This is only valid after Open has returned successfully.
+  HANDLE handle() const { return handle_.Get(); }
+
+  // @returns true if the trace file is streamed to a named pipe.
+  bool stream() const { return stream_; }
+
+  // The block size of the trace files streamed to a named pipe, which have
+  // no volume to take it from.
+  static const size_t kStreamBlockSize;
+
  protected:
+  // Opens the trace file with the given CreateFile flags.
+  bool OpenWithFlags(const base::FilePath& path, DWORD flags);
+
+  // Writes a run of blocks to a reserved range of the trace file, waiting for
+  // the write to complete.
+  // @param data The blocks to write.
+  // @param length The length of @p data, a multiple of the block size.
+  // @param offset The offset of the range, a multiple of the block size.
+  // @returns true on success, false otherwise.
+  bool WriteBlocks(const void* data, size_t length, uint64_t offset);
+
+  // Writes the segment index after the last reserved record.
+  // @returns true on success, false otherwise.
+  bool WriteSegmentIndex();
+
   // The path to the trace file being written.
   base::FilePath path_;
 
@@ -110,6 +228,25 @@ class TraceFileWriter {
   // The block size being used by the trace file writer.
   size_t block_size_;
 
+  // Whether the trace file was opened for overlapped I/O.
+  bool overlapped_;
+
+  // Whether the trace file is streamed to a named pipe.
+  bool stream_;
+
+  // The offset in the trace file past the last reserved block.
+  uint64_t next_offset_;
+
+  // Whether segments may be compressed.
+  bool compress_segments_;
+
+  // Whether the segment index is written.
+  bool index_segments_;
+
+  // The index entries of the segments reserved so far, if index_segments_
+  // is true.
+  std::vector<TraceFileSegmentIndexEntry> segment_index_;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(TraceFileWriter);
 };
@@ -0,0 +1,135 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/trace_file_writer_pool.h"
+
+#include "base/logging.h"
+#include "syzygy/common/com_utils.h"
+
+namespace trace {
+namespace service {
+
+TraceFileWriterPool::TraceFileWriterPool() {
+}
+
+TraceFileWriterPool::~TraceFileWriterPool() {
+  Stop();
+}
+
+bool TraceFileWriterPool::Start(size_t num_threads) {
+  DCHECK_LT(0u, num_threads);
+  DCHECK(!port_.IsValid());
+
+  port_.Set(::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0,
+                                     static_cast<DWORD>(num_threads)));
+  if (!port_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create I/O completion port: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.push_back(std::unique_ptr<base::DelegateSimpleThread>(
+        new base::DelegateSimpleThread(this, "trace-file-writer")));
+    threads_.back()->Start();
+  }
+
+  return true;
+}
+
+void TraceFileWriterPool::Stop() {
+  if (!port_.IsValid())
+    return;
+
+  // A packet without a handler tells a pool thread to stop. As packets are
+  // dequeued in order, the threads only see these once the requests posted
+  // before have been dispatched.
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    if (!::PostQueuedCompletionStatus(port_.Get(), 0, 0, NULL)) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Failed to stop trace file writer thread: "
+                 << ::common::LogWe(error) << ".";
+    }
+  }
+  for (auto& thread : threads_)
+    thread->Join();
+
+  threads_.clear();
+  port_.Close();
+}
+
+bool TraceFileWriterPool::RegisterIOHandler(HANDLE file, IOHandler* handler) {
+  DCHECK_NE(INVALID_HANDLE_VALUE, file);
+  DCHECK(handler != NULL);
+  DCHECK(port_.IsValid());
+
+  if (::CreateIoCompletionPort(file, port_.Get(),
+                               reinterpret_cast<ULONG_PTR>(handler),
+                               0) != port_.Get()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to associate trace file with I/O completion port: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  return true;
+}
+
+bool TraceFileWriterPool::Post(IOHandler* handler, OVERLAPPED* overlapped) {
+  DCHECK(handler != NULL);
+  DCHECK(overlapped != NULL);
+  DCHECK(port_.IsValid());
+
+  if (!::PostQueuedCompletionStatus(port_.Get(), 0,
+                                    reinterpret_cast<ULONG_PTR>(handler),
+                                    overlapped)) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to post trace file writer request: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  return true;
+}
+
+void TraceFileWriterPool::Run() {
+  while (true) {
+    DWORD bytes_transferred = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED* overlapped = NULL;
+    DWORD error = ERROR_SUCCESS;
+    if (!::GetQueuedCompletionStatus(port_.Get(), &bytes_transferred, &key,
+                                     &overlapped, INFINITE)) {
+      error = ::GetLastError();
+
+      // Without an OVERLAPPED structure nothing was dequeued, which only
+      // happens if the port itself is broken.
+      if (overlapped == NULL) {
+        LOG(ERROR) << "Failed to dequeue from I/O completion port: "
+                   << ::common::LogWe(error) << ".";
+        return;
+      }
+    }
+
+    IOHandler* handler = reinterpret_cast<IOHandler*>(key);
+    if (handler == NULL)
+      return;
+
+    handler->OnIOCompleted(overlapped, bytes_transferred, error);
+  }
+}
+
+}  // namespace service
+}  // namespace trace
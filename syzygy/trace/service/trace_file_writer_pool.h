@@ -0,0 +1,105 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file declares the TraceFileWriterPool class, a pool of threads that
+// service an I/O completion port on behalf of trace file writers. Writers
+// associate their trace files with the port and issue overlapped writes; the
+// completions, and any requests posted to the pool, are dispatched to the
+// writer on whichever pool thread dequeues them.
+
+#ifndef SYZYGY_TRACE_SERVICE_TRACE_FILE_WRITER_POOL_H_
+#define SYZYGY_TRACE_SERVICE_TRACE_FILE_WRITER_POOL_H_
+
+#include <windows.h>
+#include <memory>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/threading/simple_thread.h"
+#include "base/win/scoped_handle.h"
+
+namespace trace {
+namespace service {
+
+class TraceFileWriterPool : public base::DelegateSimpleThread::Delegate {
+ public:
+  // The interface through which completions are dispatched. This plays the
+  // same role as base::MessageLoopForIO::IOHandler, but may be invoked on
+  // several threads at once.
+  class IOHandler {
+   public:
+    // Invoked on a pool thread when an overlapped operation completes, or
+    // when a request posted with Post is dequeued.
+    // @param overlapped the OVERLAPPED structure of the operation or request.
+    // @param bytes_transferred the number of bytes transferred. This is zero
+    //     for posted requests.
+    // @param error the error of the operation, or ERROR_SUCCESS.
+    virtual void OnIOCompleted(OVERLAPPED* overlapped,
+                               DWORD bytes_transferred,
+                               DWORD error) = 0;
+
+   protected:
+    virtual ~IOHandler() {}
+  };
+
+  TraceFileWriterPool();
+  ~TraceFileWriterPool() override;
+
+  // Creates the completion port and starts the pool threads.
+  // @param num_threads the number of pool threads. This must be non-zero.
+  // @returns true on success, false otherwise.
+  bool Start(size_t num_threads);
+
+  // Stops the pool threads once they have dispatched everything queued
+  // before this call. Writes still in flight at that point are not waited
+  // for, so callers should stop the pool once their writers are idle.
+  void Stop();
+
+  // Associates a file opened for overlapped I/O with the completion port.
+  // Completions of overlapped operations on @p file are dispatched to
+  // @p handler.
+  // @param file the file to associate.
+  // @param handler the handler of the completions.
+  // @returns true on success, false otherwise.
+  bool RegisterIOHandler(HANDLE file, IOHandler* handler);
+
+  // Posts a request to the pool, to be dispatched to @p handler on a pool
+  // thread.
+  // @param handler the handler of the request.
+  // @param overlapped the OVERLAPPED structure identifying the request.
+  // @returns true on success, false otherwise.
+  bool Post(IOHandler* handler, OVERLAPPED* overlapped);
+
+  // @returns the number of pool threads.
+  size_t num_threads() const { return threads_.size(); }
+
+ private:
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override;
+  // @}
+
+  // The completion port serviced by the pool threads.
+  base::win::ScopedHandle port_;
+
+  // The pool threads.
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceFileWriterPool);
+};
+
+}  // namespace service
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_SERVICE_TRACE_FILE_WRITER_POOL_H_
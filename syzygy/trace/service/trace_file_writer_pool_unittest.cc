@@ -0,0 +1,136 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/trace_file_writer_pool.h"
+
+#include <set>
+#include <vector>
+
+#include "base/files/file_util.h"
+#include "base/synchronization/lock.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/platform_thread.h"
+#include "gtest/gtest.h"
+#include "syzygy/core/unittest_util.h"
+#include "syzygy/trace/service/trace_file_writer.h"
+
+namespace trace {
+namespace service {
+
+namespace {
+
+class TestIOHandler : public TraceFileWriterPool::IOHandler {
+ public:
+  explicit TestIOHandler(size_t expected_count)
+      : expected_count_(expected_count),
+        done_(true, false) {
+  }
+
+  void OnIOCompleted(OVERLAPPED* overlapped,
+                     DWORD bytes_transferred,
+                     DWORD error) override {
+    base::AutoLock lock(lock_);
+    completions_.push_back(overlapped);
+    bytes_transferred_.push_back(bytes_transferred);
+    errors_.push_back(error);
+    thread_ids_.insert(base::PlatformThread::CurrentId());
+    if (completions_.size() == expected_count_)
+      done_.Signal();
+  }
+
+  void Wait() { done_.Wait(); }
+
+  size_t expected_count_;
+  base::WaitableEvent done_;
+
+  base::Lock lock_;
+  std::vector<OVERLAPPED*> completions_;
+  std::vector<DWORD> bytes_transferred_;
+  std::vector<DWORD> errors_;
+  std::set<base::PlatformThreadId> thread_ids_;
+};
+
+}  // namespace
+
+TEST(TraceFileWriterPoolTest, StartAndStop) {
+  TraceFileWriterPool pool;
+  ASSERT_TRUE(pool.Start(4));
+  EXPECT_EQ(4u, pool.num_threads());
+  pool.Stop();
+  EXPECT_EQ(0u, pool.num_threads());
+}
+
+TEST(TraceFileWriterPoolTest, PostDispatchesToPoolThreads) {
+  const size_t kRequestCount = 100;
+  TestIOHandler handler(kRequestCount);
+  std::vector<OVERLAPPED> requests(kRequestCount);
+
+  TraceFileWriterPool pool;
+  ASSERT_TRUE(pool.Start(2));
+  for (auto& request : requests)
+    ASSERT_TRUE(pool.Post(&handler, &request));
+  handler.Wait();
+  pool.Stop();
+
+  EXPECT_EQ(kRequestCount, handler.completions_.size());
+  for (size_t i = 0; i < kRequestCount; ++i) {
+    EXPECT_EQ(0u, handler.bytes_transferred_[i]);
+    EXPECT_EQ(static_cast<DWORD>(ERROR_SUCCESS), handler.errors_[i]);
+  }
+  EXPECT_EQ(0u, handler.thread_ids_.count(base::PlatformThread::CurrentId()));
+}
+
+TEST(TraceFileWriterPoolTest, DispatchesWriteCompletions) {
+  testing::ScopedTempFile temp_file;
+  TraceFileWriter writer;
+  ASSERT_TRUE(writer.OpenOverlapped(temp_file.path()));
+
+  const size_t kWriteCount = 4;
+  TestIOHandler handler(kWriteCount);
+  TraceFileWriterPool pool;
+  ASSERT_TRUE(pool.Start(2));
+  ASSERT_TRUE(pool.RegisterIOHandler(writer.handle(), &handler));
+
+  // Unbuffered writes need block-aligned memory.
+  size_t block_size = writer.block_size();
+  uint8_t* data = reinterpret_cast<uint8_t*>(
+      ::VirtualAlloc(NULL, block_size, MEM_COMMIT, PAGE_READWRITE));
+  ASSERT_TRUE(data != NULL);
+  ::memset(data, 0xCC, block_size);
+
+  std::vector<OVERLAPPED> writes(kWriteCount);
+  for (size_t i = 0; i < kWriteCount; ++i) {
+    writes[i] = OVERLAPPED();
+    writes[i].Offset = static_cast<DWORD>(i * block_size);
+    BOOL written = ::WriteFile(writer.handle(), data, block_size, NULL,
+                               &writes[i]);
+    ASSERT_TRUE(written || ::GetLastError() == ERROR_IO_PENDING);
+  }
+  handler.Wait();
+  pool.Stop();
+  ::VirtualFree(data, 0, MEM_RELEASE);
+
+  for (size_t i = 0; i < kWriteCount; ++i) {
+    EXPECT_EQ(block_size, handler.bytes_transferred_[i]);
+    EXPECT_EQ(static_cast<DWORD>(ERROR_SUCCESS), handler.errors_[i]);
+  }
+
+  ASSERT_TRUE(writer.Close());
+  int64_t file_size = 0;
+  ASSERT_TRUE(base::GetFileSize(temp_file.path(), &file_size));
+  EXPECT_EQ(static_cast<int64_t>(kWriteCount * block_size), file_size);
+}
+
+}  // namespace service
+}  // namespace trace
@@ -14,9 +14,14 @@
 
 #include "syzygy/trace/service/trace_file_writer.h"
 
+#include <string>
+#include <vector>
+
 #include "base/files/file_util.h"
 #include "gtest/gtest.h"
 #include "syzygy/common/align.h"
+#include "syzygy/core/serialization.h"
+#include "syzygy/core/zstream.h"
 #include "syzygy/pe/unittest_util.h"
 #include "syzygy/trace/protocol/call_trace_defs.h"
 #include "syzygy/trace/service/process_info.h"
@@ -43,6 +48,45 @@ class TraceFileWriterTest : public testing::PELibUnitTest {
   base::FilePath trace_path;
 };
 
+// Appends a record of the given type and timestamp, with @p size bytes of
+// data, to @p segment.
+void AppendRecord(uint16_t type,
+                  uint64_t timestamp,
+                  size_t size,
+                  std::vector<uint8_t>* segment) {
+  RecordPrefix prefix = {};
+  prefix.timestamp = timestamp;
+  prefix.size = static_cast<uint32_t>(size);
+  prefix.type = type;
+  prefix.version.hi = TRACE_VERSION_HI;
+  prefix.version.lo = TRACE_VERSION_LO;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&prefix);
+  segment->insert(segment->end(), bytes, bytes + sizeof(prefix));
+  segment->resize(segment->size() + size, 0);
+}
+
+// Builds a block aligned segment record holding @p records.
+void BuildSegment(uint32_t thread_id,
+                  const std::vector<uint8_t>& records,
+                  size_t block_size,
+                  std::vector<uint8_t>* data) {
+  data->assign(::common::AlignUp(sizeof(RecordPrefix) +
+                                     sizeof(TraceFileSegmentHeader) +
+                                     records.size(),
+                                 block_size),
+               0);
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data->data());
+  TraceFileSegmentHeader* header = reinterpret_cast<TraceFileSegmentHeader*>(
+      record + 1);
+  record->size = sizeof(TraceFileSegmentHeader);
+  record->type = TraceFileSegmentHeader::kTypeId;
+  record->version.hi = TRACE_VERSION_HI;
+  record->version.lo = TRACE_VERSION_LO;
+  header->thread_id = thread_id;
+  header->segment_length = static_cast<uint32_t>(records.size());
+  ::memcpy(header + 1, records.data(), records.size());
+}
+
 }  // namespace
 
 TEST_F(TraceFileWriterTest, GenerateTraceFileBaseName) {
@@ -180,5 +224,250 @@ TEST_F(TraceFileWriterTest, WriteRecordSucceeds) {
   EXPECT_EQ(0, trace_file_size % w.block_size());
 }
 
+TEST_F(TraceFileWriterTest, CompressRecord) {
+  TestTraceFileWriter w;
+  w.set_compress_segments(true);
+  ASSERT_TRUE(w.Open(trace_path));
+
+  ProcessInfo pi;
+  ASSERT_TRUE(pi.Initialize(::GetCurrentProcessId()));
+  ASSERT_TRUE(w.WriteHeader(pi));
+
+  // A segment of repetitive records, as traces mostly are.
+  const size_t kSegmentLength = 16 * 1024;
+  std::vector<uint8_t> data;
+  data.resize(::common::AlignUp(
+      sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader) + kSegmentLength,
+      w.block_size()));
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data.data());
+  TraceFileSegmentHeader* header = reinterpret_cast<TraceFileSegmentHeader*>(
+      record + 1);
+  record->size = sizeof(TraceFileSegmentHeader);
+  record->type = TraceFileSegmentHeader::kTypeId;
+  record->version.hi = TRACE_VERSION_HI;
+  record->version.lo = TRACE_VERSION_LO;
+  header->thread_id = 42;
+  header->segment_length = kSegmentLength;
+  uint8_t* segment = reinterpret_cast<uint8_t*>(header + 1);
+  for (size_t i = 0; i < kSegmentLength; ++i)
+    segment[i] = static_cast<uint8_t>(i % 16);
+  std::vector<uint8_t> expected_segment(segment, segment + kSegmentLength);
+
+  ASSERT_TRUE(w.CompressRecord(data.data(), data.size()));
+  EXPECT_EQ(TraceFileCompressedSegmentHeader::kTypeId, record->type);
+  EXPECT_EQ(sizeof(TraceFileCompressedSegmentHeader), record->size);
+  const TraceFileCompressedSegmentHeader* compressed_header =
+      reinterpret_cast<const TraceFileCompressedSegmentHeader*>(record + 1);
+  EXPECT_EQ(42u, compressed_header->thread_id);
+  EXPECT_EQ(kSegmentLength, compressed_header->uncompressed_length);
+  EXPECT_GT(kSegmentLength, compressed_header->segment_length);
+
+  // The compressed segment can't be compressed further.
+  EXPECT_FALSE(w.CompressRecord(data.data(), data.size()));
+
+  // It decompresses to the original segment.
+  const uint8_t* compressed = reinterpret_cast<const uint8_t*>(
+      compressed_header + 1);
+  core::ScopedInStreamPtr in_stream(core::CreateByteInStream(
+      compressed, compressed + compressed_header->segment_length));
+  core::ZInStream unzip_stream(in_stream.get());
+  ASSERT_TRUE(unzip_stream.Init());
+  std::vector<uint8_t> uncompressed(kSegmentLength);
+  size_t bytes_read = 0;
+  ASSERT_TRUE(unzip_stream.Read(uncompressed.size(), uncompressed.data(),
+                                &bytes_read));
+  EXPECT_EQ(kSegmentLength, bytes_read);
+  EXPECT_EQ(expected_segment, uncompressed);
+
+  // It's written in fewer blocks.
+  size_t bytes_to_write = 0;
+  uint64_t offset = 0;
+  ASSERT_TRUE(w.ReserveRecord(data.data(), data.size(), &bytes_to_write,
+                              &offset));
+  EXPECT_GT(data.size(), bytes_to_write);
+  EXPECT_TRUE(w.WriteRecord(data.data(), data.size()));
+}
+
+TEST_F(TraceFileWriterTest, WriteRecordFailsCompressedWithoutCompression) {
+  TestTraceFileWriter w;
+  ASSERT_TRUE(w.Open(trace_path));
+
+  ProcessInfo pi;
+  ASSERT_TRUE(pi.Initialize(::GetCurrentProcessId()));
+  ASSERT_TRUE(w.WriteHeader(pi));
+
+  std::vector<uint8_t> data;
+  data.resize(::common::AlignUp(
+      sizeof(RecordPrefix) + sizeof(TraceFileCompressedSegmentHeader) + 1,
+      w.block_size()));
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data.data());
+  TraceFileCompressedSegmentHeader* header =
+      reinterpret_cast<TraceFileCompressedSegmentHeader*>(record + 1);
+  record->size = sizeof(TraceFileCompressedSegmentHeader);
+  record->type = TraceFileCompressedSegmentHeader::kTypeId;
+  record->version.hi = TRACE_VERSION_HI;
+  record->version.lo = TRACE_VERSION_LO;
+  header->segment_length = 1;
+  header->uncompressed_length = 1;
+
+  EXPECT_FALSE(w.WriteRecord(data.data(), data.size()));
+}
+
+TEST_F(TraceFileWriterTest, ReserveAndWriteRecordOverlapped) {
+  TestTraceFileWriter w;
+  ASSERT_TRUE(w.OpenOverlapped(trace_path));
+
+  ProcessInfo pi;
+  ASSERT_TRUE(pi.Initialize(::GetCurrentProcessId()));
+  ASSERT_TRUE(w.WriteHeader(pi));
+
+  std::vector<uint8_t> data;
+  data.resize(sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader) + 1);
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data.data());
+  TraceFileSegmentHeader* header = reinterpret_cast<TraceFileSegmentHeader*>(
+      record + 1);
+  record->size = sizeof(TraceFileSegmentHeader);
+  record->type = TraceFileSegmentHeader::kTypeId;
+  record->version.hi = TRACE_VERSION_HI;
+  record->version.lo = TRACE_VERSION_LO;
+  header->segment_length = 1;
+  data.resize(::common::AlignUp(data.size(), w.block_size()));
+
+  // Records are reserved one after the other, past the header.
+  size_t bytes_to_write = 0;
+  uint64_t offset1 = 0;
+  uint64_t offset2 = 0;
+  ASSERT_TRUE(w.ReserveRecord(data.data(), data.size(), &bytes_to_write,
+                              &offset1));
+  EXPECT_EQ(data.size(), bytes_to_write);
+  EXPECT_LT(0u, offset1);
+  EXPECT_EQ(0u, offset1 % w.block_size());
+  ASSERT_TRUE(w.ReserveRecord(data.data(), data.size(), &bytes_to_write,
+                              &offset2));
+  EXPECT_EQ(offset1 + bytes_to_write, offset2);
+
+  // Empty records reserve nothing.
+  header->segment_length = 0;
+  uint64_t offset3 = 0;
+  ASSERT_TRUE(w.ReserveRecord(data.data(), data.size(), &bytes_to_write,
+                              &offset3));
+  EXPECT_EQ(0u, bytes_to_write);
+  EXPECT_EQ(offset2 + data.size(), offset3);
+
+  // Synchronous writes go after the reserved records.
+  header->segment_length = 1;
+  EXPECT_TRUE(w.WriteRecord(data.data(), data.size()));
+
+  ASSERT_TRUE(w.Close());
+  int64_t trace_file_size = 0;
+  ASSERT_TRUE(base::GetFileSize(trace_path, &trace_file_size));
+  EXPECT_EQ(offset3 + data.size(), static_cast<uint64_t>(trace_file_size));
+}
+
+TEST_F(TraceFileWriterTest, SummarizeSegment) {
+  std::vector<uint8_t> records;
+  AppendRecord(TRACE_ENTER_EVENT, 20, 4, &records);
+  AppendRecord(TRACE_EXIT_EVENT, 10, 0, &records);
+  AppendRecord(TRACE_MODULE_EVENT, 30, 8, &records);
+
+  TraceFileSegmentIndexEntry entry = {};
+  TraceFileWriter::SummarizeSegment(records.data(), records.size(), &entry);
+  EXPECT_EQ(10u, entry.first_timestamp);
+  EXPECT_EQ(30u, entry.last_timestamp);
+  EXPECT_EQ(
+      TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_ENTER_EVENT) |
+          TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_EXIT_EVENT) |
+          TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_MODULE_EVENT),
+      entry.record_types);
+
+  // A record overrunning the segment is ignored.
+  AppendRecord(TRACE_BATCH_ENTER, 40, 16, &records);
+  TraceFileWriter::SummarizeSegment(records.data(), records.size() - 1,
+                                    &entry);
+  EXPECT_EQ(30u, entry.last_timestamp);
+  EXPECT_EQ(0u, entry.record_types &
+                    TraceFileSegmentIndexEntry::GetRecordTypeBit(
+                        TRACE_BATCH_ENTER));
+}
+
+TEST_F(TraceFileWriterTest, WriteSegmentIndex) {
+  TestTraceFileWriter w;
+  w.set_index_segments(true);
+  w.set_compress_segments(true);
+  ASSERT_TRUE(w.Open(trace_path));
+
+  ProcessInfo pi;
+  ASSERT_TRUE(pi.Initialize(::GetCurrentProcessId()));
+  ASSERT_TRUE(w.WriteHeader(pi));
+
+  // An uncompressed segment, and a compressed one.
+  std::vector<uint8_t> records;
+  AppendRecord(TRACE_ENTER_EVENT, 10, 4, &records);
+  AppendRecord(TRACE_EXIT_EVENT, 20, 4, &records);
+  std::vector<uint8_t> data;
+  BuildSegment(1, records, w.block_size(), &data);
+  ASSERT_TRUE(w.WriteRecord(data.data(), data.size()));
+
+  records.clear();
+  for (size_t i = 0; i < 1024; ++i)
+    AppendRecord(TRACE_MODULE_EVENT, 100 + i, 4, &records);
+  BuildSegment(2, records, w.block_size(), &data);
+  ASSERT_TRUE(w.CompressRecord(data.data(), data.size()));
+  ASSERT_TRUE(w.WriteRecord(data.data(), data.size()));
+
+  ASSERT_EQ(2u, w.segment_index().size());
+  std::vector<TraceFileSegmentIndexEntry> expected_entries(
+      w.segment_index());
+  EXPECT_EQ(1u, expected_entries[0].thread_id);
+  EXPECT_EQ(10u, expected_entries[0].first_timestamp);
+  EXPECT_EQ(20u, expected_entries[0].last_timestamp);
+  EXPECT_EQ(2u, expected_entries[1].thread_id);
+  EXPECT_EQ(100u, expected_entries[1].first_timestamp);
+  EXPECT_EQ(1123u, expected_entries[1].last_timestamp);
+  EXPECT_EQ(TraceFileSegmentIndexEntry::GetRecordTypeBit(TRACE_MODULE_EVENT),
+            expected_entries[1].record_types);
+  EXPECT_LT(expected_entries[0].offset, expected_entries[1].offset);
+  ASSERT_TRUE(w.Close());
+
+  std::string contents;
+  ASSERT_TRUE(base::ReadFileToString(trace_path, &contents));
+  ASSERT_EQ(0u, contents.size() % w.block_size());
+
+  // The header is flagged, and the trailer locates the index.
+  const TraceFileHeader* file_header =
+      reinterpret_cast<const TraceFileHeader*>(contents.data());
+  EXPECT_NE(0u, file_header->flags & TraceFileHeader::kSegmentIndex);
+  ASSERT_LE(sizeof(TraceFileSegmentIndexTrailer), contents.size());
+  const TraceFileSegmentIndexTrailer* trailer =
+      reinterpret_cast<const TraceFileSegmentIndexTrailer*>(
+          contents.data() + contents.size() -
+          sizeof(TraceFileSegmentIndexTrailer));
+  EXPECT_EQ(0, ::memcmp(&trailer->signature,
+                        &TraceFileSegmentIndexTrailer::kSignatureValue,
+                        sizeof(trailer->signature)));
+  ASSERT_LT(expected_entries[1].offset, trailer->index_offset);
+  ASSERT_GT(contents.size(), trailer->index_offset);
+
+  const RecordPrefix* prefix = reinterpret_cast<const RecordPrefix*>(
+      contents.data() + trailer->index_offset);
+  EXPECT_EQ(TraceFileSegmentIndex::kTypeId, prefix->type);
+  EXPECT_EQ(contents.size() - trailer->index_offset,
+            sizeof(RecordPrefix) + prefix->size);
+  const TraceFileSegmentIndex* index =
+      reinterpret_cast<const TraceFileSegmentIndex*>(prefix + 1);
+  ASSERT_EQ(2u, index->num_entries);
+  EXPECT_EQ(0, ::memcmp(index->entries, expected_entries.data(),
+                        2 * sizeof(TraceFileSegmentIndexEntry)));
+
+  // The entries point at the segments.
+  for (size_t i = 0; i < index->num_entries; ++i) {
+    const RecordPrefix* segment_prefix = reinterpret_cast<const RecordPrefix*>(
+        contents.data() + index->entries[i].offset);
+    EXPECT_TRUE(segment_prefix->type == TraceFileSegmentHeader::kTypeId ||
+                segment_prefix->type ==
+                    TraceFileCompressedSegmentHeader::kTypeId);
+  }
+}
+
 }  // namespace service
 }  // namespace trace
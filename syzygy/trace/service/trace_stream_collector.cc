@@ -0,0 +1,433 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/trace_stream_collector.h"
+
+#include <time.h>
+
+#include <utility>
+
+#include "base/logging.h"
+#include "base/files/file_util.h"
+#include "base/strings/stringprintf.h"
+#include "syzygy/common/com_utils.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+
+namespace trace {
+namespace service {
+
+namespace {
+
+// The size of the inbound buffer of each instance of the pipe. This bounds
+// how far a service may get ahead of the collector.
+const DWORD kPipeBufferSize = 1024 * 1024;
+
+// The size of the reads from the pipe.
+const size_t kReadBufferSize = 64 * 1024;
+
+}  // namespace
+
+// Receives a stream on a thread of its own, and writes it to a trace file.
+class TraceStreamCollector::Connection
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param collector the collector that accepted the connection.
+  // @param pipe the connected instance of the pipe, of which this takes
+  //     ownership.
+  Connection(TraceStreamCollector* collector, HANDLE pipe)
+      : collector_(collector), pipe_(pipe), finished_(false) {
+    DCHECK(collector != NULL);
+    DCHECK(pipe_.IsValid());
+  }
+
+  // Starts receiving the stream.
+  // @returns true on success, false otherwise.
+  bool Start();
+
+  // Waits for the stream to end.
+  void Join() { thread_->Join(); }
+
+  // @returns true once the stream has ended.
+  // @note This must be called under the lock of the collector.
+  bool finished() const {
+    collector_->lock_.AssertAcquired();
+    return finished_;
+  }
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  void Run() override;
+  // @}
+
+ protected:
+  // Reads from the stream, waiting for data to be available.
+  // @param buffer receives the data read.
+  // @param bytes_read receives the number of bytes read.
+  // @returns true on success, false if the stream has ended or the collector
+  //     is stopped.
+  bool Read(std::vector<uint8_t>* buffer, DWORD* bytes_read);
+
+  // Receives the stream into the trace file, until it ends.
+  // @returns true on success, false on error.
+  bool Receive();
+
+  // Writes to the trace file.
+  // @param data the data to write.
+  // @param length the length of @p data.
+  // @returns true on success, false otherwise.
+  bool Write(const uint8_t* data, size_t length);
+
+  TraceStreamCollector* collector_;
+
+  // The connected instance of the pipe.
+  base::win::ScopedHandle pipe_;
+
+  // Signaled as reads from the pipe complete.
+  base::win::ScopedHandle read_event_;
+
+  // The trace file being written, once the trace file header is received.
+  base::win::ScopedHandle trace_file_;
+  base::FilePath trace_file_path_;
+
+  // Set once the stream has ended. Protected by the lock of the collector.
+  bool finished_;
+
+  std::unique_ptr<base::DelegateSimpleThread> thread_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(Connection);
+};
+
+bool TraceStreamCollector::Connection::Start() {
+  read_event_.Set(::CreateEvent(NULL, TRUE, FALSE, NULL));
+  if (!read_event_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create event: " << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  thread_.reset(
+      new base::DelegateSimpleThread(this, "TraceStreamCollector::Connection"));
+  thread_->Start();
+  return true;
+}
+
+void TraceStreamCollector::Connection::Run() {
+  if (Receive() && trace_file_.IsValid()) {
+    LOG(INFO) << "Received trace file '" << trace_file_path_.value() << "'.";
+  }
+
+  trace_file_.Close();
+  pipe_.Close();
+
+  base::AutoLock lock(collector_->lock_);
+  finished_ = true;
+}
+
+bool TraceStreamCollector::Connection::Read(std::vector<uint8_t>* buffer,
+                                            DWORD* bytes_read) {
+  DCHECK(buffer != NULL);
+  DCHECK(bytes_read != NULL);
+
+  *bytes_read = 0;
+  OVERLAPPED overlapped = {};
+  overlapped.hEvent = read_event_.Get();
+  if (!::ReadFile(pipe_.Get(), buffer->data(), buffer->size(), NULL,
+                  &overlapped)) {
+    DWORD error = ::GetLastError();
+    if (error == ERROR_BROKEN_PIPE)
+      return false;
+    if (error != ERROR_IO_PENDING) {
+      LOG(ERROR) << "Failed reading from trace stream: "
+                 << ::common::LogWe(error) << ".";
+      return false;
+    }
+  }
+
+  // Reads that complete win over the collector being stopped, so that the
+  // data already received is written.
+  HANDLE handles[] = { read_event_.Get(), collector_->stop_event_.Get() };
+  DWORD wait = ::WaitForMultipleObjects(arraysize(handles), handles, FALSE,
+                                        INFINITE);
+  if (wait != WAIT_OBJECT_0) {
+    ::CancelIo(pipe_.Get());
+    ::GetOverlappedResult(pipe_.Get(), &overlapped, bytes_read, TRUE);
+    LOG(WARNING) << "Trace stream cut short by the collector stopping.";
+    return false;
+  }
+
+  if (!::GetOverlappedResult(pipe_.Get(), &overlapped, bytes_read, FALSE)) {
+    DWORD error = ::GetLastError();
+    if (error == ERROR_BROKEN_PIPE)
+      return false;
+    LOG(ERROR) << "Failed reading from trace stream: "
+               << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  return true;
+}
+
+bool TraceStreamCollector::Connection::Receive() {
+  std::vector<uint8_t> buffer(kReadBufferSize);
+
+  // The start of the stream is held back until the fixed portion of the
+  // trace file header is received, as it names the trace file.
+  const size_t kHeaderLength = offsetof(TraceFileHeader, blob_data);
+  std::vector<uint8_t> header;
+  DWORD bytes_read = 0;
+  while (Read(&buffer, &bytes_read)) {
+    if (trace_file_.IsValid()) {
+      if (!Write(buffer.data(), bytes_read))
+        return false;
+      continue;
+    }
+
+    header.insert(header.end(), buffer.begin(), buffer.begin() + bytes_read);
+    if (header.size() < kHeaderLength)
+      continue;
+
+    const TraceFileHeader* trace_file_header =
+        reinterpret_cast<const TraceFileHeader*>(header.data());
+    if (::memcmp(&trace_file_header->signature,
+                 &TraceFileHeader::kSignatureValue,
+                 sizeof(trace_file_header->signature)) != 0) {
+      LOG(ERROR) << "Trace stream doesn't start with a trace file header.";
+      return false;
+    }
+
+    trace_file_path_ =
+        collector_->GenerateTraceFilePath(trace_file_header->process_id);
+    trace_file_.Set(::CreateFile(trace_file_path_.value().c_str(),
+                                 GENERIC_WRITE,
+                                 FILE_SHARE_READ,
+                                 NULL, /* lpSecurityAttributes */
+                                 CREATE_NEW,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 NULL /* hTemplateFile */));
+    if (!trace_file_.IsValid()) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "Failed to create '" << trace_file_path_.value()
+                 << "': " << ::common::LogWe(error) << ".";
+      return false;
+    }
+
+    if (!Write(header.data(), header.size()))
+      return false;
+    header.clear();
+  }
+
+  if (!trace_file_.IsValid() && !header.empty())
+    LOG(ERROR) << "Trace stream ended within the trace file header.";
+
+  return true;
+}
+
+bool TraceStreamCollector::Connection::Write(const uint8_t* data,
+                                             size_t length) {
+  DCHECK(data != NULL);
+  DCHECK(trace_file_.IsValid());
+
+  DWORD bytes_written = 0;
+  if (!::WriteFile(trace_file_.Get(), data, length, &bytes_written, NULL) ||
+      bytes_written != length) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed writing to '" << trace_file_path_.value()
+               << "': " << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  return true;
+}
+
+TraceStreamCollector::TraceStreamCollector(
+    const base::FilePath& pipe_name, const base::FilePath& trace_directory)
+    : pipe_name_(pipe_name),
+      trace_directory_(trace_directory),
+      num_trace_files_(0) {
+  DCHECK(!pipe_name.empty());
+  DCHECK(!trace_directory.empty());
+}
+
+TraceStreamCollector::~TraceStreamCollector() {
+  Stop();
+}
+
+bool TraceStreamCollector::Start() {
+  DCHECK(listener_.get() == NULL);
+
+  if (!base::CreateDirectory(trace_directory_)) {
+    LOG(ERROR) << "Failed to create trace directory: '"
+               << trace_directory_.value() << "'.";
+    return false;
+  }
+
+  if (!stop_event_.IsValid())
+    stop_event_.Set(::CreateEvent(NULL, TRUE, FALSE, NULL));
+  if (!stop_event_.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create event: " << ::common::LogWe(error) << ".";
+    return false;
+  }
+  ::ResetEvent(stop_event_.Get());
+
+  LOG(INFO) << "Collecting trace streams on '" << pipe_name_.value()
+            << "' into '" << trace_directory_.value() << "'.";
+  listener_.reset(new base::DelegateSimpleThread(this, "TraceStreamCollector"));
+  listener_->Start();
+  return true;
+}
+
+void TraceStreamCollector::Stop() {
+  if (listener_.get() == NULL)
+    return;
+
+  ::SetEvent(stop_event_.Get());
+  listener_->Join();
+  listener_.reset();
+  ReapConnections(true);
+}
+
+size_t TraceStreamCollector::num_trace_files() const {
+  base::AutoLock lock(lock_);
+  return num_trace_files_;
+}
+
+void TraceStreamCollector::Run() {
+  while (true) {
+    base::win::ScopedHandle pipe;
+    if (!AcceptConnection(&pipe))
+      return;
+
+    ReapConnections(false);
+
+    std::unique_ptr<Connection> connection(new Connection(this, pipe.Take()));
+    if (!connection->Start())
+      continue;
+    base::AutoLock lock(lock_);
+    connections_.push_back(std::move(connection));
+  }
+}
+
+bool TraceStreamCollector::AcceptConnection(base::win::ScopedHandle* pipe) {
+  DCHECK(pipe != NULL);
+
+  // The instances of the pipe are created one at a time. Clients that find
+  // them all connected wait for one to become free.
+  base::win::ScopedHandle new_pipe(::CreateNamedPipe(
+      pipe_name_.value().c_str(),
+      PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+      PIPE_UNLIMITED_INSTANCES,
+      0, /* nOutBufferSize */
+      kPipeBufferSize,
+      0, /* nDefaultTimeOut */
+      NULL /* lpSecurityAttributes */));
+  if (!new_pipe.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create pipe '" << pipe_name_.value()
+               << "': " << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  base::win::ScopedHandle connect_event(::CreateEvent(NULL, TRUE, FALSE, NULL));
+  if (!connect_event.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Failed to create event: " << ::common::LogWe(error) << ".";
+    return false;
+  }
+
+  // A client that connects and disconnects before we get to it leaves an
+  // empty stream behind, which is dropped by its connection.
+  OVERLAPPED overlapped = {};
+  overlapped.hEvent = connect_event.Get();
+  if (!::ConnectNamedPipe(new_pipe.Get(), &overlapped)) {
+    DWORD error = ::GetLastError();
+    if (error == ERROR_IO_PENDING) {
+      HANDLE handles[] = { connect_event.Get(), stop_event_.Get() };
+      DWORD wait = ::WaitForMultipleObjects(arraysize(handles), handles, FALSE,
+                                            INFINITE);
+      DWORD unused = 0;
+      if (wait != WAIT_OBJECT_0) {
+        ::CancelIo(new_pipe.Get());
+        ::GetOverlappedResult(new_pipe.Get(), &overlapped, &unused, TRUE);
+        return false;
+      }
+      if (!::GetOverlappedResult(new_pipe.Get(), &overlapped, &unused,
+                                 FALSE)) {
+        error = ::GetLastError();
+        LOG(ERROR) << "Failed to connect pipe '" << pipe_name_.value()
+                   << "': " << ::common::LogWe(error) << ".";
+        return false;
+      }
+    } else if (error != ERROR_PIPE_CONNECTED && error != ERROR_NO_DATA) {
+      LOG(ERROR) << "Failed to connect pipe '" << pipe_name_.value()
+                 << "': " << ::common::LogWe(error) << ".";
+      return false;
+    }
+  }
+
+  pipe->Set(new_pipe.Take());
+  return true;
+}
+
+void TraceStreamCollector::ReapConnections(bool wait_for_all) {
+  // The connections are joined outside of the lock, which they take as they
+  // end.
+  std::vector<std::unique_ptr<Connection>> ended;
+  {
+    base::AutoLock lock(lock_);
+    auto it = connections_.begin();
+    while (it != connections_.end()) {
+      if (wait_for_all || (*it)->finished()) {
+        ended.push_back(std::move(*it));
+        it = connections_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  for (const auto& connection : ended)
+    connection->Join();
+}
+
+base::FilePath TraceStreamCollector::GenerateTraceFilePath(
+    uint32_t process_id) {
+  size_t sequence = 0;
+  {
+    base::AutoLock lock(lock_);
+    sequence = num_trace_files_++;
+  }
+
+  // As in TraceFileWriter::GenerateTraceFileBaseName, the current time
+  // disambiguates the trace files of successive collectors.
+  time_t t = time(NULL);
+  struct tm local_time = {};
+  ::localtime_s(&local_time, &t);
+
+  return trace_directory_.Append(base::StringPrintf(
+      L"trace-stream-%4d%02d%02d%02d%02d%02d-%d-%d.bin",
+      1900 + local_time.tm_year,
+      1 + local_time.tm_mon,
+      local_time.tm_mday,
+      local_time.tm_hour,
+      local_time.tm_min,
+      local_time.tm_sec,
+      process_id,
+      static_cast<int>(sequence)));
+}
+
+}  // namespace service
+}  // namespace trace
@@ -0,0 +1,124 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// This file declares the TraceStreamCollector class, which receives trace
+// files streamed by call trace services over a named pipe, and writes them to
+// a trace directory. Named pipes may be connected to from other machines,
+// so this lets traces be collected away from the machine being traced.
+//
+// Each call trace service session streams its trace file over a connection
+// of its own, which the collector reads on a dedicated thread. The streams
+// are flow controlled by the pipe: a collector that falls behind stalls the
+// service's trace file writer, whose pending buffers then hold back the
+// clients once the session's buffer pool is capped.
+//
+// Intended use:
+//
+//   TraceStreamCollector collector(pipe_name, trace_directory);
+//   if (!collector.Start())
+//     ...
+//   ...
+//   collector.Stop();
+
+#ifndef SYZYGY_TRACE_SERVICE_TRACE_STREAM_COLLECTOR_H_
+#define SYZYGY_TRACE_SERVICE_TRACE_STREAM_COLLECTOR_H_
+
+#include <memory>
+#include <vector>
+
+#include "base/files/file_path.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/simple_thread.h"
+#include "base/win/scoped_handle.h"
+
+namespace trace {
+namespace service {
+
+class TraceStreamCollector : public base::DelegateSimpleThread::Delegate {
+ public:
+  // @param pipe_name The name of the pipe on which to receive streams, of the
+  //     form \\.\pipe\name.
+  // @param trace_directory The directory to which to write the trace files.
+  TraceStreamCollector(const base::FilePath& pipe_name,
+                       const base::FilePath& trace_directory);
+
+  // Stops the collector if it's running.
+  ~TraceStreamCollector() override;
+
+  // Starts listening for streams on a thread of its own.
+  // @returns true on success, false otherwise.
+  bool Start();
+
+  // Stops listening for streams, and waits for the connections to end. Streams
+  // that are cut short leave truncated trace files behind.
+  void Stop();
+
+  // @returns the number of trace files written so far, including those still
+  //     being received.
+  size_t num_trace_files() const;
+
+  // @name base::DelegateSimpleThread::Delegate implementation.
+  // @{
+  // Listens for connections until the collector is stopped.
+  void Run() override;
+  // @}
+
+ protected:
+  class Connection;
+
+  // Waits for a client to connect to a new instance of the pipe.
+  // @param pipe receives the connected instance of the pipe.
+  // @returns true on success, false if the collector is stopped or the pipe
+  //     can't be created.
+  bool AcceptConnection(base::win::ScopedHandle* pipe);
+
+  // Joins the threads of the connections that have ended.
+  // @param wait_for_all true to also wait for the connections still running.
+  void ReapConnections(bool wait_for_all);
+
+  // Generates a name for the trace file of a stream, which is unique to this
+  // collector.
+  // @param process_id the process whose trace file is streamed.
+  // @returns the path of the trace file.
+  base::FilePath GenerateTraceFilePath(uint32_t process_id);
+
+  // The name of the pipe on which to receive streams.
+  base::FilePath pipe_name_;
+
+  // The directory to which the trace files are written.
+  base::FilePath trace_directory_;
+
+  // Signaled when the collector is stopped.
+  base::win::ScopedHandle stop_event_;
+
+  // The thread listening for connections, while the collector is running.
+  std::unique_ptr<base::DelegateSimpleThread> listener_;
+
+  // Protects the members below.
+  mutable base::Lock lock_;
+
+  // The connections being received, and those ended but not yet joined.
+  std::vector<std::unique_ptr<Connection>> connections_;
+
+  // The number of trace files written so far.
+  size_t num_trace_files_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(TraceStreamCollector);
+};
+
+}  // namespace service
+}  // namespace trace
+
+#endif  // SYZYGY_TRACE_SERVICE_TRACE_STREAM_COLLECTOR_H_
@@ -0,0 +1,179 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/trace/service/trace_stream_collector.h"
+
+#include <string>
+#include <vector>
+
+#include "base/files/file_enumerator.h"
+#include "base/files/file_util.h"
+#include "base/strings/stringprintf.h"
+#include "gtest/gtest.h"
+#include "syzygy/common/align.h"
+#include "syzygy/pe/unittest_util.h"
+#include "syzygy/trace/protocol/call_trace_defs.h"
+#include "syzygy/trace/service/process_info.h"
+#include "syzygy/trace/service/trace_file_writer.h"
+
+namespace trace {
+namespace service {
+
+namespace {
+
+class TraceStreamCollectorTest : public testing::PELibUnitTest {
+ public:
+  void SetUp() override {
+    testing::PELibUnitTest::SetUp();
+    CreateTemporaryDir(&temp_dir);
+    pipe_name = base::FilePath(base::StringPrintf(
+        L"\\\\.\\pipe\\syzygy-trace-stream-collector-test-%d",
+        ::GetCurrentProcessId()));
+  }
+
+  // @returns the files in the temporary directory.
+  std::vector<base::FilePath> GetTraceFiles() {
+    std::vector<base::FilePath> trace_files;
+    base::FileEnumerator enumerator(temp_dir, false,
+                                    base::FileEnumerator::FILES);
+    for (base::FilePath path = enumerator.Next(); !path.empty();
+         path = enumerator.Next()) {
+      trace_files.push_back(path);
+    }
+    return trace_files;
+  }
+
+  base::FilePath temp_dir;
+  base::FilePath pipe_name;
+};
+
+// Builds a block aligned segment record with a single record of @p size
+// bytes.
+void BuildSegment(size_t size, size_t block_size, std::vector<uint8_t>* data) {
+  const size_t kHeaderLength =
+      sizeof(RecordPrefix) + sizeof(TraceFileSegmentHeader);
+  size_t segment_length = sizeof(RecordPrefix) + size;
+  data->assign(::common::AlignUp(kHeaderLength + segment_length, block_size),
+               0);
+
+  RecordPrefix* record = reinterpret_cast<RecordPrefix*>(data->data());
+  record->size = sizeof(TraceFileSegmentHeader);
+  record->type = TraceFileSegmentHeader::kTypeId;
+  record->version.hi = TRACE_VERSION_HI;
+  record->version.lo = TRACE_VERSION_LO;
+  TraceFileSegmentHeader* header =
+      reinterpret_cast<TraceFileSegmentHeader*>(record + 1);
+  header->thread_id = ::GetCurrentThreadId();
+  header->segment_length = static_cast<uint32_t>(segment_length);
+
+  RecordPrefix* prefix = reinterpret_cast<RecordPrefix*>(header + 1);
+  prefix->size = static_cast<uint32_t>(size);
+  prefix->type = TRACE_BATCH_ENTER;
+  prefix->version.hi = TRACE_VERSION_HI;
+  prefix->version.lo = TRACE_VERSION_LO;
+}
+
+}  // namespace
+
+TEST_F(TraceStreamCollectorTest, OpenPipeFailsWithoutCollector) {
+  TraceFileWriter w;
+  EXPECT_FALSE(w.OpenPipe(pipe_name));
+  EXPECT_FALSE(w.stream());
+}
+
+TEST_F(TraceStreamCollectorTest, StartAndStop) {
+  TraceStreamCollector collector(pipe_name, temp_dir);
+  ASSERT_TRUE(collector.Start());
+  collector.Stop();
+  EXPECT_EQ(0u, collector.num_trace_files());
+  EXPECT_TRUE(GetTraceFiles().empty());
+}
+
+TEST_F(TraceStreamCollectorTest, CollectsStreams) {
+  TraceStreamCollector collector(pipe_name, temp_dir);
+  ASSERT_TRUE(collector.Start());
+
+  ProcessInfo pi;
+  ASSERT_TRUE(pi.Initialize(::GetCurrentProcessId()));
+
+  // Stream two trace files at once, each over a connection of its own.
+  TraceFileWriter w1;
+  TraceFileWriter w2;
+  ASSERT_TRUE(w1.OpenPipe(pipe_name));
+  ASSERT_TRUE(w2.OpenPipe(pipe_name));
+  EXPECT_TRUE(w1.stream());
+  EXPECT_EQ(TraceFileWriter::kStreamBlockSize, w1.block_size());
+  ASSERT_TRUE(w1.WriteHeader(pi));
+  ASSERT_TRUE(w2.WriteHeader(pi));
+
+  // The first stream is larger than the inbound buffer of the pipe.
+  std::vector<uint8_t> segment;
+  BuildSegment(100 * 1024, w1.block_size(), &segment);
+  for (size_t i = 0; i < 20; ++i)
+    ASSERT_TRUE(w1.WriteRecord(segment.data(), segment.size()));
+  BuildSegment(10, w2.block_size(), &segment);
+  ASSERT_TRUE(w2.WriteRecord(segment.data(), segment.size()));
+
+  // Closing waits for the collector to have read the streams.
+  uint64_t size1 = w1.next_offset();
+  uint64_t size2 = w2.next_offset();
+  ASSERT_TRUE(w1.Close());
+  ASSERT_TRUE(w2.Close());
+  collector.Stop();
+  EXPECT_EQ(2u, collector.num_trace_files());
+
+  // The trace files are laid out as they would be on disk.
+  std::vector<base::FilePath> trace_files = GetTraceFiles();
+  ASSERT_EQ(2u, trace_files.size());
+  std::vector<uint64_t> sizes;
+  for (const base::FilePath& trace_file : trace_files) {
+    std::string contents;
+    ASSERT_TRUE(base::ReadFileToString(trace_file, &contents));
+    ASSERT_LE(sizeof(TraceFileHeader), contents.size());
+    const TraceFileHeader* header =
+        reinterpret_cast<const TraceFileHeader*>(contents.data());
+    EXPECT_EQ(0, ::memcmp(&header->signature,
+                          &TraceFileHeader::kSignatureValue,
+                          sizeof(header->signature)));
+    EXPECT_EQ(TraceFileWriter::kStreamBlockSize, header->block_size);
+    EXPECT_EQ(pi.process_id, header->process_id);
+    sizes.push_back(contents.size());
+  }
+  EXPECT_TRUE((sizes[0] == size1 && sizes[1] == size2) ||
+              (sizes[0] == size2 && sizes[1] == size1));
+}
+
+TEST_F(TraceStreamCollectorTest, DropsStreamsWithoutHeader) {
+  TraceStreamCollector collector(pipe_name, temp_dir);
+  ASSERT_TRUE(collector.Start());
+
+  base::win::ScopedHandle pipe(::CreateFile(
+      pipe_name.value().c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL, NULL));
+  ASSERT_TRUE(pipe.IsValid());
+  // This is long enough to hold a trace file header, but has no signature.
+  std::vector<uint8_t> garbage(TraceFileWriter::kStreamBlockSize, 0xCC);
+  DWORD bytes_written = 0;
+  ASSERT_TRUE(::WriteFile(pipe.Get(), garbage.data(), garbage.size(),
+                          &bytes_written, NULL));
+  ASSERT_TRUE(::FlushFileBuffers(pipe.Get()));
+  pipe.Close();
+
+  collector.Stop();
+  EXPECT_EQ(0u, collector.num_trace_files());
+  EXPECT_TRUE(GetTraceFiles().empty());
+}
+
+}  // namespace service
+}  // namespace trace
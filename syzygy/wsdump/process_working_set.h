@@ -71,6 +71,9 @@ class ProcessWorkingSet {
   const ModuleStatsVector& module_stats() const { return module_stats_; }
 
  protected:
+  // The sampler shares the module enumeration.
+  friend class WorkingSetSampler;
+
   // These are protected members to allow unittesting them.
   typedef std::unique_ptr<PSAPI_WORKING_SET_INFORMATION> ScopedWsPtr;
   static bool CaptureWorkingSet(HANDLE process, ScopedWsPtr* working_set);
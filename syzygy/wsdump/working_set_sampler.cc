@@ -0,0 +1,227 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/wsdump/working_set_sampler.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "base/logging.h"
+#include "syzygy/common/com_utils.h"
+#include "syzygy/core/address_space.h"
+#include "syzygy/wsdump/process_working_set.h"
+
+namespace wsdump {
+
+namespace {
+
+const size_t kPageSize = 4096;
+
+bool LessModuleName(const WorkingSetSampler::ModuleDelta& a,
+                    const WorkingSetSampler::ModuleDelta& b) {
+  return a.module_name < b.module_name;
+}
+
+}  // namespace
+
+const char WorkingSetSampler::kHeadersSectionName[] = "(headers)";
+
+WorkingSetSampler::WorkingSetSampler() {
+}
+
+WorkingSetSampler::~WorkingSetSampler() {
+}
+
+bool WorkingSetSampler::Initialize(DWORD process_id) {
+  ProcessWorkingSet::ModuleAddressSpace modules;
+  if (!ProcessWorkingSet::CaptureModules(process_id, &modules))
+    return false;
+
+  const DWORD kProcessPermissions = PROCESS_QUERY_INFORMATION | PROCESS_VM_READ;
+  process_.Set(::OpenProcess(kProcessPermissions, FALSE, process_id));
+  if (!process_.IsValid()) {
+    DWORD err = ::GetLastError();
+    LOG(ERROR) << "OpenProcess failed: " << common::LogWe(err);
+    return false;
+  }
+
+  std::vector<Module> new_modules;
+  size_t entry_count = 0;
+  ProcessWorkingSet::ModuleAddressSpace::RangeMap::const_iterator it =
+      modules.ranges().begin();
+  for (; it != modules.ranges().end(); ++it) {
+    size_t base = it->first.start();
+    size_t size = it->first.size();
+
+    new_modules.push_back(Module());
+    Module& module = new_modules.back();
+    module.name = it->second;
+    module.first_entry = entry_count;
+    module.page_count = (size + kPageSize - 1) / kPageSize;
+    if (!CaptureSections(process_.Get(), base, size, &module))
+      return false;
+
+    entry_count += module.page_count;
+  }
+
+  // Fill in the addresses to be queried. These remain valid for the lifetime
+  // of the modules, so they are never rebuilt.
+  std::vector<PSAPI_WORKING_SET_EX_INFORMATION> new_entries(entry_count);
+  it = modules.ranges().begin();
+  for (size_t i = 0; i < new_modules.size(); ++i, ++it) {
+    const Module& module = new_modules[i];
+    for (size_t page = 0; page < module.page_count; ++page) {
+      new_entries[module.first_entry + page].VirtualAddress =
+          reinterpret_cast<PVOID>(it->first.start() + page * kPageSize);
+    }
+  }
+
+  modules_.swap(new_modules);
+  entries_.swap(new_entries);
+  resident_.assign(entry_count, false);
+  return true;
+}
+
+bool WorkingSetSampler::Sample(ModuleDeltaVector* deltas) {
+  DCHECK(deltas != NULL);
+  DCHECK(process_.IsValid());
+
+  deltas->clear();
+
+  if (!entries_.empty() &&
+      !::QueryWorkingSetEx(process_.Get(), &entries_[0],
+                           entries_.size() * sizeof(entries_[0]))) {
+    DWORD err = ::GetLastError();
+    LOG(ERROR) << "QueryWorkingSetEx failed: " << common::LogWe(err);
+    return false;
+  }
+
+  deltas->reserve(modules_.size());
+  std::vector<SectionDelta> sections;
+  for (size_t i = 0; i < modules_.size(); ++i) {
+    const Module& module = modules_[i];
+
+    sections.clear();
+    sections.resize(module.sections.size());
+    for (size_t j = 0; j < module.sections.size(); ++j)
+      sections[j].section_name = module.sections[j].name;
+
+    for (size_t page = 0; page < module.page_count; ++page) {
+      size_t entry = module.first_entry + page;
+      bool was_resident = resident_[entry];
+      bool is_resident = entries_[entry].VirtualAttributes.Valid != 0;
+      resident_[entry] = is_resident;
+
+      SectionDelta& section = sections[module.page_sections[page]];
+      if (is_resident)
+        ++section.resident_pages;
+      if (is_resident && !was_resident)
+        ++section.page_ins;
+      else if (!is_resident && was_resident)
+        ++section.page_outs;
+    }
+
+    deltas->push_back(ModuleDelta());
+    ModuleDelta& delta = deltas->back();
+    delta.module_name = module.name;
+    for (size_t j = 0; j < sections.size(); ++j) {
+      const SectionDelta& section = sections[j];
+      if (section.resident_pages == 0 && section.page_outs == 0)
+        continue;
+      delta.sections.push_back(section);
+    }
+  }
+
+  std::sort(deltas->begin(), deltas->end(), LessModuleName);
+  return true;
+}
+
+bool WorkingSetSampler::CaptureSections(HANDLE process,
+                                        size_t base,
+                                        size_t size,
+                                        Module* module) {
+  DCHECK(process != NULL);
+  DCHECK(module != NULL);
+
+  module->sections.clear();
+  module->page_sections.assign(module->page_count, 0);
+
+  Section headers = { kHeadersSectionName, 0, 0 };
+  module->sections.push_back(headers);
+
+  // The headers, including the section table, are expected to fit in the
+  // first page of the image.
+  uint8_t buffer[kPageSize] = {};
+  size_t to_read = std::min(size, sizeof(buffer));
+  SIZE_T bytes_read = 0;
+  if (!::ReadProcessMemory(process, reinterpret_cast<const void*>(base),
+                           buffer, to_read, &bytes_read) ||
+      bytes_read != to_read) {
+    DWORD err = ::GetLastError();
+    LOG(ERROR) << "ReadProcessMemory failed: " << common::LogWe(err);
+    return false;
+  }
+
+  const IMAGE_DOS_HEADER* dos_header =
+      reinterpret_cast<const IMAGE_DOS_HEADER*>(buffer);
+  if (to_read < sizeof(*dos_header) ||
+      dos_header->e_magic != IMAGE_DOS_SIGNATURE ||
+      dos_header->e_lfanew < 0 ||
+      dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS) > to_read) {
+    LOG(ERROR) << "Module has invalid or unreadable headers.";
+    return false;
+  }
+
+  const IMAGE_NT_HEADERS* nt_headers =
+      reinterpret_cast<const IMAGE_NT_HEADERS*>(buffer + dos_header->e_lfanew);
+  const IMAGE_SECTION_HEADER* section_header = IMAGE_FIRST_SECTION(nt_headers);
+  size_t section_count = nt_headers->FileHeader.NumberOfSections;
+  if (reinterpret_cast<const uint8_t*>(section_header + section_count) >
+          buffer + to_read) {
+    LOG(ERROR) << "Section table not contained in the first page of module.";
+    return false;
+  }
+
+  for (size_t i = 0; i < section_count; ++i, ++section_header) {
+    size_t section_size = section_header->Misc.VirtualSize;
+    if (section_size == 0)
+      section_size = section_header->SizeOfRawData;
+
+    Section section = {};
+    section.name.assign(
+        reinterpret_cast<const char*>(section_header->Name),
+        strnlen(reinterpret_cast<const char*>(section_header->Name),
+                IMAGE_SIZEOF_SHORT_NAME));
+    section.first_page = std::min(
+        static_cast<size_t>(section_header->VirtualAddress / kPageSize),
+        module->page_count);
+    size_t end_page = std::min(
+        (section_header->VirtualAddress + section_size + kPageSize - 1) /
+            kPageSize,
+        module->page_count);
+    section.page_count = end_page - section.first_page;
+
+    size_t index = module->sections.size();
+    module->sections.push_back(section);
+    for (size_t page = section.first_page; page < end_page; ++page)
+      module->page_sections[page] = index;
+  }
+
+  module->sections[0].page_count = std::count(
+      module->page_sections.begin(), module->page_sections.end(), 0);
+
+  return true;
+}
+
+}  // namespace wsdump
@@ -0,0 +1,144 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Implementation class to periodically sample the working set of a process,
+// reporting per-module and per-section page-ins and page-outs between
+// successive samples.
+
+#ifndef SYZYGY_WSDUMP_WORKING_SET_SAMPLER_H_
+#define SYZYGY_WSDUMP_WORKING_SET_SAMPLER_H_
+
+#include <windows.h>
+#include <psapi.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/win/scoped_handle.h"
+
+namespace wsdump {
+
+// Samples the residency of the image pages of the modules loaded in a given
+// process. Rather than capturing the whole working set on every sample, the
+// pages of interest are enumerated once and only those are queried via
+// QueryWorkingSetEx. Each sample is diffed against the previous one.
+//
+// Usage:
+//   WorkingSetSampler sampler;
+//   if (!sampler.Initialize(pid))
+//     ...
+//   while (...) {
+//     WorkingSetSampler::ModuleDeltaVector deltas;
+//     if (!sampler.Sample(&deltas))
+//       ...
+//     ::Sleep(interval);
+//   }
+//
+// @note The set of modules is captured by Initialize; modules loaded after
+//     that point are not sampled.
+class WorkingSetSampler {
+ public:
+  // The change in residency of one section of a module between two samples.
+  struct SectionDelta {
+    SectionDelta() : resident_pages(0), page_ins(0), page_outs(0) {}
+
+    std::string section_name;
+    // The number of pages of the section in the working set.
+    size_t resident_pages;
+    // The number of pages that entered the working set since the last sample.
+    size_t page_ins;
+    // The number of pages that left the working set since the last sample.
+    size_t page_outs;
+  };
+
+  // The changes in residency of the sections of one module.
+  struct ModuleDelta {
+    std::wstring module_name;
+    std::vector<SectionDelta> sections;
+  };
+  typedef std::vector<ModuleDelta> ModuleDeltaVector;
+
+  // The name reported for the pages of a module that aren't part of any
+  // section, i.e. the image headers.
+  static const char kHeadersSectionName[];
+
+  WorkingSetSampler();
+  ~WorkingSetSampler();
+
+  // Prepares to sample the working set of the given process. This enumerates
+  // the modules of the process and their sections.
+  // @param process_id The ID of the process to be sampled.
+  // @returns true on success, false on failure.
+  bool Initialize(DWORD process_id);
+
+  // Samples the working set and reports the differences to the previous
+  // sample. On the first call every resident page is reported as a page-in.
+  // @param deltas Receives one entry per module, sorted by module name. Only
+  //     sections that are resident or have changed are reported.
+  // @returns true on success, false on failure.
+  bool Sample(ModuleDeltaVector* deltas);
+
+ protected:
+  // A section of a module, as a range of pages relative to the first page of
+  // the module.
+  struct Section {
+    std::string name;
+    size_t first_page;
+    size_t page_count;
+  };
+
+  // A module being sampled. Its pages occupy a contiguous run of the query
+  // buffer, starting at |first_entry|.
+  struct Module {
+    std::wstring name;
+    size_t first_entry;
+    size_t page_count;
+    // Sorted by first_page. Entry 0 is the pseudo-section for the headers and
+    // any other pages not covered by a section.
+    std::vector<Section> sections;
+    // The section index of each page of the module.
+    std::vector<size_t> page_sections;
+  };
+
+  // Reads the section table of the module at @p base in @p process.
+  // @param process A handle to the process, with PROCESS_VM_READ access.
+  // @param base The address at which the module is loaded.
+  // @param size The size of the module image.
+  // @param module The module whose sections and page_sections are populated.
+  // @returns true on success, false on failure.
+  static bool CaptureSections(HANDLE process,
+                              size_t base,
+                              size_t size,
+                              Module* module);
+
+  // The process being sampled.
+  base::win::ScopedHandle process_;
+
+  // The modules being sampled, sorted by name.
+  std::vector<Module> modules_;
+
+  // The query buffer, holding one entry per page of every module. The
+  // addresses are filled in once; QueryWorkingSetEx updates the attributes.
+  std::vector<PSAPI_WORKING_SET_EX_INFORMATION> entries_;
+
+  // The residency of each entry in the previous sample.
+  std::vector<bool> resident_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WorkingSetSampler);
+};
+
+}  // namespace wsdump
+
+#endif  // SYZYGY_WSDUMP_WORKING_SET_SAMPLER_H_
@@ -0,0 +1,120 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "syzygy/wsdump/working_set_sampler.h"
+
+#include <map>
+#include <string>
+
+#include "base/strings/string_util.h"
+#include "gtest/gtest.h"
+
+namespace wsdump {
+
+namespace {
+
+typedef WorkingSetSampler::ModuleDelta ModuleDelta;
+typedef WorkingSetSampler::ModuleDeltaVector ModuleDeltaVector;
+typedef WorkingSetSampler::SectionDelta SectionDelta;
+
+std::wstring GetExeName() {
+  std::wstring exe_name;
+  ::GetModuleFileName(NULL, base::WriteInto(&exe_name, MAX_PATH), MAX_PATH);
+  exe_name.resize(wcslen(exe_name.c_str()));
+  return exe_name;
+}
+
+const ModuleDelta* FindModule(const ModuleDeltaVector& deltas,
+                              const std::wstring& module_name) {
+  for (size_t i = 0; i < deltas.size(); ++i) {
+    if (deltas[i].module_name == module_name)
+      return &deltas[i];
+  }
+  return NULL;
+}
+
+const SectionDelta* FindSection(const ModuleDelta& delta,
+                                const std::string& section_name) {
+  for (size_t i = 0; i < delta.sections.size(); ++i) {
+    if (delta.sections[i].section_name == section_name)
+      return &delta.sections[i];
+  }
+  return NULL;
+}
+
+}  // namespace
+
+TEST(WorkingSetSamplerTest, FirstSampleReportsResidentPagesAsPageIns) {
+  WorkingSetSampler sampler;
+  ASSERT_TRUE(sampler.Initialize(::GetCurrentProcessId()));
+
+  ModuleDeltaVector deltas;
+  ASSERT_TRUE(sampler.Sample(&deltas));
+
+  for (size_t i = 1; i < deltas.size(); ++i)
+    EXPECT_LT(deltas[i - 1].module_name, deltas[i].module_name);
+
+  // The code being run right now must be resident.
+  const ModuleDelta* exe = FindModule(deltas, GetExeName());
+  ASSERT_TRUE(exe != NULL);
+  const SectionDelta* text = FindSection(*exe, ".text");
+  ASSERT_TRUE(text != NULL);
+  EXPECT_LT(0u, text->resident_pages);
+
+  for (size_t i = 0; i < deltas.size(); ++i) {
+    for (size_t j = 0; j < deltas[i].sections.size(); ++j) {
+      const SectionDelta& section = deltas[i].sections[j];
+      EXPECT_EQ(section.resident_pages, section.page_ins);
+      EXPECT_EQ(0u, section.page_outs);
+    }
+  }
+}
+
+TEST(WorkingSetSamplerTest, SuccessiveSamplesAreConsistent) {
+  WorkingSetSampler sampler;
+  ASSERT_TRUE(sampler.Initialize(::GetCurrentProcessId()));
+
+  ModuleDeltaVector first;
+  ASSERT_TRUE(sampler.Sample(&first));
+
+  // Evict as much as possible so that the next sample sees page-outs.
+  ::SetProcessWorkingSetSize(::GetCurrentProcess(),
+                             static_cast<SIZE_T>(-1),
+                             static_cast<SIZE_T>(-1));
+
+  ModuleDeltaVector second;
+  ASSERT_TRUE(sampler.Sample(&second));
+  ASSERT_EQ(first.size(), second.size());
+
+  for (size_t i = 0; i < second.size(); ++i) {
+    ASSERT_EQ(first[i].module_name, second[i].module_name);
+
+    std::map<std::string, size_t> first_resident;
+    for (size_t j = 0; j < first[i].sections.size(); ++j) {
+      const SectionDelta& section = first[i].sections[j];
+      first_resident[section.section_name] = section.resident_pages;
+    }
+
+    // The residency must be the previous residency plus the page-ins, minus
+    // the page-outs.
+    for (size_t j = 0; j < second[i].sections.size(); ++j) {
+      const SectionDelta& section = second[i].sections[j];
+      EXPECT_EQ(section.resident_pages,
+                first_resident[section.section_name] + section.page_ins -
+                    section.page_outs);
+    }
+  }
+}
+
+}  // namespace wsdump
@@ -14,18 +14,24 @@
 
 #include <iostream>
 #include <list>
+#include <vector>
 
 #include "base/at_exit.h"
 #include "base/command_line.h"
 #include "base/logging.h"
 #include "base/files/file_util.h"
 #include "base/process/process_iterator.h"
+#include "base/strings/string_number_conversions.h"
 #include "base/strings/utf_string_conversions.h"
+#include "base/threading/platform_thread.h"
+#include "base/time/time.h"
 #include "pcrecpp.h"  // NOLINT
 #include "syzygy/core/json_file_writer.h"
 #include "syzygy/wsdump/process_working_set.h"
+#include "syzygy/wsdump/working_set_sampler.h"
 
 using wsdump::ProcessWorkingSet;
+using wsdump::WorkingSetSampler;
 
 namespace {
 
@@ -68,10 +74,25 @@ bool RegexpProcessFilter::Includes(const base::ProcessEntry& entry) const {
 
 const char kUsage[] =
 "Usage: wsdump [--process-name=<process_re>]\n"
+"              [--sample-interval=<ms> [--sample-count=<count>]]\n"
 "\n"
 "    Captures and outputs working set statistics for all processes,\n"
 "    or only for processess whose executable name matches <process_re>.\n"
 "\n"
+"    If --sample-interval is specified, the working sets are instead\n"
+"    sampled every <ms> milliseconds, <count> times (default 10), and\n"
+"    the changes between successive samples are output. Each process then\n"
+"    has a \"samples\" array instead of \"modules\". Each sample has a\n"
+"    \"time_ms\" key, the time since sampling started, and a \"modules\"\n"
+"    array listing the modules with changes. Each of those has a\n"
+"    \"module_name\" and a \"sections\" array, with one dictionary per\n"
+"    changed section with the following keys:\n"
+"      * section_name - the section name, e.g. \".text\".\n"
+"      * resident_pages - pages of the section in the working set.\n"
+"      * page_ins - pages that entered the working set since the last\n"
+"        sample. In the first sample, all resident pages.\n"
+"      * page_outs - pages that left the working set since the last sample.\n"
+"\n"
 "    The output is JSON encoded array, where each element of the array\n"
 "    is a dictionary describing a process. Each process has the following\n"
 "    items:\n"
@@ -173,6 +194,154 @@ void OutputProcessInfo(const ProcessInfo& info,
   json->CloseDict();
 }
 
+// A time series of working set changes for a process.
+struct ProcessSamples {
+  struct Sample {
+    base::TimeDelta time;
+    WorkingSetSampler::ModuleDeltaVector deltas;
+  };
+
+  ProcessSamples() : pid(0), parent_pid(0) {
+  }
+
+  std::wstring exe_file;
+  base::ProcessId pid;
+  base::ProcessId parent_pid;
+  WorkingSetSampler sampler;
+  std::vector<Sample> samples;
+};
+
+void OutputSection(const WorkingSetSampler::SectionDelta& section,
+                   core::JSONFileWriter* json) {
+  DCHECK(json != NULL);
+
+  json->OpenDict();
+  json->OutputKey("section_name");
+  json->OutputString(section.section_name);
+  json->OutputKey("resident_pages");
+  json->OutputInteger(section.resident_pages);
+  json->OutputKey("page_ins");
+  json->OutputInteger(section.page_ins);
+  json->OutputKey("page_outs");
+  json->OutputInteger(section.page_outs);
+  json->CloseDict();
+}
+
+void OutputSample(const ProcessSamples::Sample& sample,
+                  core::JSONFileWriter* json) {
+  DCHECK(json != NULL);
+
+  json->OpenDict();
+  json->OutputKey("time_ms");
+  json->OutputInteger(static_cast<int>(sample.time.InMilliseconds()));
+  json->OutputKey("modules");
+  json->OpenList();
+  for (size_t i = 0; i < sample.deltas.size(); ++i) {
+    const WorkingSetSampler::ModuleDelta& module = sample.deltas[i];
+
+    bool opened = false;
+    for (size_t j = 0; j < module.sections.size(); ++j) {
+      const WorkingSetSampler::SectionDelta& section = module.sections[j];
+      if (section.page_ins == 0 && section.page_outs == 0)
+        continue;
+
+      // Modules without changes are omitted entirely.
+      if (!opened) {
+        json->OpenDict();
+        json->OutputKey("module_name");
+        json->OutputString(module.module_name);
+        json->OutputKey("sections");
+        json->OpenList();
+        opened = true;
+      }
+      OutputSection(section, json);
+    }
+    if (opened) {
+      json->CloseList();
+      json->CloseDict();
+    }
+  }
+  json->CloseList();
+  json->CloseDict();
+}
+
+void OutputProcessSamples(const ProcessSamples& info,
+                          core::JSONFileWriter* json) {
+  DCHECK(json != NULL);
+
+  json->OpenDict();
+  json->OutputKey("exe_file");
+  json->OutputString(info.exe_file);
+  json->OutputKey("pid");
+  json->OutputInteger(info.pid);
+  json->OutputKey("parent_pid");
+  json->OutputInteger(info.parent_pid);
+
+  json->OutputKey("samples");
+  json->OpenList();
+  for (size_t i = 0; i < info.samples.size(); ++i)
+    OutputSample(info.samples[i], json);
+  json->CloseList();
+  json->CloseDict();
+}
+
+// Samples the working sets of the processes matching @p filter and outputs
+// the changes between samples.
+int SampleWorkingSets(const base::ProcessFilter& filter,
+                      base::TimeDelta interval,
+                      size_t count) {
+  typedef std::list<ProcessSamples> ProcessSamplesList;
+  ProcessSamplesList processes;
+
+  const base::ProcessEntry* entry = NULL;
+  base::ProcessIterator process_iterator(&filter);
+  entry = process_iterator.NextProcessEntry();
+  while (entry) {
+    processes.push_back(ProcessSamples());
+    ProcessSamples& info = processes.back();
+    if (info.sampler.Initialize(entry->pid())) {
+      info.exe_file = entry->exe_file();
+      info.pid = entry->pid();
+      info.parent_pid = entry->parent_pid();
+    } else {
+      LOG(ERROR) << "Unable to initialize working set sampling for pid: "
+                 << entry->pid();
+      processes.pop_back();
+    }
+    entry = process_iterator.NextProcessEntry();
+  }
+
+  base::TimeTicks start = base::TimeTicks::Now();
+  for (size_t i = 0; i < count; ++i) {
+    if (i != 0)
+      base::PlatformThread::Sleep(interval);
+
+    base::TimeDelta time = base::TimeTicks::Now() - start;
+    ProcessSamplesList::iterator it = processes.begin();
+    while (it != processes.end()) {
+      it->samples.push_back(ProcessSamples::Sample());
+      ProcessSamples::Sample& sample = it->samples.back();
+      sample.time = time;
+      if (!it->sampler.Sample(&sample.deltas)) {
+        // The process has most likely exited. Keep what we have so far.
+        LOG(ERROR) << "Unable to sample working set for pid: " << it->pid;
+        it->samples.pop_back();
+      }
+      ++it;
+    }
+  }
+
+  core::JSONFileWriter json(stdout, true);
+  json.OpenList();
+  ProcessSamplesList::const_iterator it = processes.begin();
+  for (; it != processes.end(); ++it)
+    OutputProcessSamples(*it, &json);
+  json.CloseList();
+  json.Flush();
+
+  return 0;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -201,6 +370,28 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  if (cmd_line->HasSwitch("sample-interval")) {
+    int interval_ms = 0;
+    if (!base::StringToInt(cmd_line->GetSwitchValueASCII("sample-interval"),
+                           &interval_ms) ||
+        interval_ms <= 0) {
+      LOG(ERROR) << "Invalid sample interval.";
+      return Usage();
+    }
+
+    size_t count = 10;
+    if (cmd_line->HasSwitch("sample-count") &&
+        (!base::StringToSizeT(cmd_line->GetSwitchValueASCII("sample-count"),
+                              &count) ||
+         count == 0)) {
+      LOG(ERROR) << "Invalid sample count.";
+      return Usage();
+    }
+
+    return SampleWorkingSets(
+        filter, base::TimeDelta::FromMilliseconds(interval_ms), count);
+  }
+
   typedef std::list<ProcessInfo> WorkingSets;
   WorkingSets working_sets;
 
@@ -27,10 +27,15 @@
 // The matching PDB file is completely rewritten to guarantee that it is
 // canonical (as long as the underlying PdbWriter doesn't change). We load all
 // of the streams into memory, reach in and make local modifications, and
-// rewrite the entire file to disk.
+// rewrite the entire file to disk. In in-place mode only the handful of
+// streams that are modified are read, and they are written back over their
+// existing pages; none of the modifications change the length of a stream.
 
 #include "syzygy/zap_timestamp/zap_timestamp.h"
 
+#include <windows.h>
+#include <imagehlp.h>
+
 #include "base/at_exit.h"
 #include "base/bind.h"
 #include "base/command_line.h"
@@ -39,7 +44,9 @@
 #include "base/files/file_util.h"
 #include "base/files/scoped_temp_dir.h"
 #include "base/strings/stringprintf.h"
+#include "base/win/scoped_handle.h"
 #include "syzygy/block_graph/typed_block.h"
+#include "syzygy/common/com_utils.h"
 #include "syzygy/core/file_util.h"
 #include "syzygy/pdb/pdb_byte_stream.h"
 #include "syzygy/pdb/pdb_constants.h"
@@ -47,10 +54,10 @@
 #include "syzygy/pdb/pdb_util.h"
 #include "syzygy/pdb/pdb_writer.h"
 #include "syzygy/pe/find.h"
+#include "syzygy/pe/mapped_file.h"
 #include "syzygy/pe/pdb_info.h"
 #include "syzygy/pe/pe_data.h"
 #include "syzygy/pe/pe_file_parser.h"
-#include "syzygy/pe/pe_file_writer.h"
 
 namespace zap_timestamp {
 
@@ -286,47 +293,79 @@ bool Md5Consume(size_t bytes, FILE* file, base::MD5Context* context) {
   return true;
 }
 
+// Applies @p updates to the PE file at @p path and recomputes its checksum.
+// The file is mapped once and patched through the mapping, so the checksum
+// pass is the only full read of the file.
 bool UpdateFileInPlace(const base::FilePath& path,
                        const PatchAddressSpace& updates) {
   LOG(INFO) << "Patching file: " << path.value();
 
-  base::ScopedFILE file(base::OpenFile(path, "rb+"));
-  if (file.get() == NULL) {
-    LOG(ERROR) << "Unable to open file for updating: " << path.value();
+  base::win::ScopedHandle file(
+      ::CreateFile(path.value().c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                   OPEN_EXISTING, 0, NULL));
+  if (!file.IsValid()) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to open file for updating: " << path.value() << ": "
+               << common::LogWe(error);
+    return false;
+  }
+
+  DWORD file_size = ::GetFileSize(file.Get(), NULL);
+  base::win::ScopedHandle mapping(
+      ::CreateFileMapping(file.Get(), NULL, PAGE_READWRITE, 0, 0, NULL));
+  uint8_t* data = NULL;
+  if (mapping.IsValid()) {
+    data = reinterpret_cast<uint8_t*>(
+        ::MapViewOfFile(mapping.Get(), FILE_MAP_WRITE, 0, 0, file_size));
+  }
+  if (data == NULL) {
+    DWORD error = ::GetLastError();
+    LOG(ERROR) << "Unable to map file for updating: " << path.value() << ": "
+               << common::LogWe(error);
     return false;
   }
 
+  bool success = true;
   PatchAddressSpace::const_iterator it = updates.begin();
   for (; it != updates.end(); ++it) {
     // No data? Then nothing to update. This happens for the PE checksum, which
-    // has a NULL data pointer. We update it later on in another pass.
+    // has a NULL data pointer. We update it below.
     if (it->second.data == NULL)
       continue;
 
+    if (it->first.end().value() > file_size) {
+      LOG(ERROR) << "Patch " << it->second.name << " at " << it->first.start()
+                 << " lies beyond the end of file: " << path.value();
+      success = false;
+      break;
+    }
+
     LOG(INFO) << "  Patching " << it->second.name << ", " << it->first.size()
               << " bytes at " << it->first.start();
+    ::memcpy(data + it->first.start().value(), it->second.data,
+             it->first.size());
+  }
 
-    // Seek to the position to be updated.
-    if (::fseek(file.get(), it->first.start().value(), SEEK_SET) != 0) {
-      LOG(ERROR) << "Failed to seek to " << it->first.start()
-                 << " of file: " << path.value();
-      return false;
-    }
-
-    // Write the updated data.
-    size_t bytes_written =
-        ::fwrite(it->second.data, 1, it->first.size(), file.get());
-    if (bytes_written != it->first.size()) {
-      LOG(ERROR) << "Failed to write " << it->first.size() << " bytes to "
-                 << "position " << it->first.start()
-                 << " of file: " << path.value();
+  if (success) {
+    LOG(INFO) << "Updating checksum for PE file: " << path.value();
+    DWORD original_checksum = 0;
+    DWORD new_checksum = 0;
+    IMAGE_NT_HEADERS* nt_headers = ::CheckSumMappedFile(
+        data, file_size, &original_checksum, &new_checksum);
+    if (nt_headers == NULL) {
+      DWORD error = ::GetLastError();
+      LOG(ERROR) << "CheckSumMappedFile failed: " << common::LogWe(error);
+      success = false;
+    } else {
+      nt_headers->OptionalHeader.CheckSum = new_checksum;
     }
   }
 
-  LOG(INFO) << "Finished patching file: " << path.value();
-  file.reset();
+  CHECK(::UnmapViewOfFile(data));
 
-  return true;
+  if (success)
+    LOG(INFO) << "Finished patching file: " << path.value();
+  return success;
 }
 
 // Ensures that the stream with the given ID is writable, returning a scoped
@@ -494,7 +533,9 @@ ZapTimestamp::ZapTimestamp()
       dos_header_block_(NULL),
       write_image_(true),
       write_pdb_(true),
-      overwrite_(false) {
+      overwrite_(false),
+      patch_pdb_in_place_(false),
+      pdb_page_size_(0) {
   // The timestamp can't just be set to zero as that represents a special
   // value in the PE file. We set it to some arbitrary fixed date in the past.
   // This is Jan 1, 2010, 0:00:00 GMT. This date shouldn't be too much in
@@ -773,45 +814,35 @@ bool ZapTimestamp::CalculatePdbGuid() {
 
   LOG(INFO) << "Calculating PDB GUID from PE file contents.";
 
-  base::ScopedFILE pe_file(base::OpenFile(input_image_, "rb"));
-  if (pe_file.get() == NULL) {
-    LOG(ERROR) << "Failed to open PE file for reading: "
+  pe::MappedFile pe_file;
+  if (!pe_file.Init(input_image_)) {
+    LOG(ERROR) << "Failed to map PE file for reading: "
                << input_image_.value();
     return false;
   }
-
-  // Get the length of the entire file.
-  if (::fseek(pe_file.get(), 0, SEEK_END) != 0) {
-    LOG(ERROR) << "Failed to fseek to end of file.";
-    return false;
-  }
-  FileOffsetAddress end(::ftell(pe_file.get()));
-
-  // Seek back to the beginning.
-  if (::fseek(pe_file.get(), 0, SEEK_SET) != 0) {
-    LOG(ERROR) << "Failed to fseek to beginning of file.";
-    return false;
-  }
+  const char* data = reinterpret_cast<const char*>(pe_file.data());
+  FileOffsetAddress end(pe_file.size());
 
   // Initialize the MD5 structure.
   base::MD5Context md5_context = {0};
   base::MD5Init(&md5_context);
 
-  // We seek through the bits of the file that will be changed, and skip those.
-  // The rest of the file (the static parts) are fed through an MD5 hash and
-  // used to generated a unique and stable GUID.
+  // We skip over the bits of the file that will be changed. The rest of the
+  // file (the static parts) are fed through an MD5 hash and used to generated
+  // a unique and stable GUID.
   FileOffsetAddress cur(0);
   PatchAddressSpace::const_iterator range_it = pe_file_addr_space_.begin();
   for (; range_it != pe_file_addr_space_.end(); ++range_it) {
+    if (range_it->first.end() > end) {
+      LOG(ERROR) << "Marked range lies beyond the end of the PE file.";
+      return false;
+    }
+
     // Consume any data before this range.
     if (cur < range_it->first.start()) {
       size_t bytes_to_hash = range_it->first.start() - cur;
-      if (!Md5Consume(bytes_to_hash, pe_file.get(), &md5_context))
-        return false;  // This logs verbosely for us.
-    }
-
-    if (::fseek(pe_file.get(), range_it->first.size(), SEEK_CUR)) {
-      LOG(ERROR) << "Failed to fseek past marked range.";
+      base::MD5Update(&md5_context,
+                      base::StringPiece(data + cur.value(), bytes_to_hash));
     }
 
     cur = range_it->first.end();
@@ -819,12 +850,10 @@ bool ZapTimestamp::CalculatePdbGuid() {
 
   // Consume any left-over data.
   if (cur < end) {
-    if (!Md5Consume(end - cur, pe_file.get(), &md5_context))
-      return false;  // This logs verbosely for us.
+    base::MD5Update(&md5_context,
+                    base::StringPiece(data + cur.value(), end - cur));
   }
 
-  DCHECK_EQ(end.value(), static_cast<uint32_t>(::ftell(pe_file.get())));
-
   static_assert(sizeof(base::MD5Digest) == sizeof(pdb_guid_data_),
                 "MD5Digest and GUID size mismatch.");
   base::MD5Final(reinterpret_cast<base::MD5Digest*>(&pdb_guid_data_),
@@ -850,9 +879,13 @@ bool ZapTimestamp::LoadAndUpdatePdbFile() {
 
   // We turf the old directory stream as a fresh PDB does not have one. It's
   // also meaningless after we rewrite a PDB as the old blocks it refers to
-  // will no longer exist.
+  // will no longer exist. In place its contents are zeroed instead.
+  if (!RecordPdbStreamPages(pdb::kPdbOldDirectoryStream))
+    return false;
   pdb_file_->ReplaceStream(pdb::kPdbOldDirectoryStream, NULL);
 
+  if (!RecordPdbStreamPages(pdb::kPdbHeaderInfoStream))
+    return false;
   scoped_refptr<PdbStream> header_reader =
       GetWritableStream(pdb::kPdbHeaderInfoStream, pdb_file_.get());
   if (header_reader.get() == NULL) {
@@ -872,6 +905,8 @@ bool ZapTimestamp::LoadAndUpdatePdbFile() {
   header_writer->Write(pdb_guid_data_);
 
   // Normalize the DBI stream in place.
+  if (!RecordPdbStreamPages(pdb::kDbiStream))
+    return false;
   scoped_refptr<PdbByteStream> dbi_stream(new PdbByteStream());
   CHECK(dbi_stream->Init(pdb_file_->GetStream(pdb::kDbiStream).get()));
   pdb_file_->ReplaceStream(pdb::kDbiStream, dbi_stream.get());
@@ -884,6 +919,8 @@ bool ZapTimestamp::LoadAndUpdatePdbFile() {
   pdb::DbiHeader* dbi_header = reinterpret_cast<pdb::DbiHeader*>(dbi_data);
 
   // Normalize the symbol record stream in place.
+  if (!RecordPdbStreamPages(dbi_header->symbol_record_stream))
+    return false;
   scoped_refptr<PdbByteStream> symrec_stream(new PdbByteStream());
   CHECK(symrec_stream->Init(
       pdb_file_->GetStream(dbi_header->symbol_record_stream).get()));
@@ -896,6 +933,8 @@ bool ZapTimestamp::LoadAndUpdatePdbFile() {
 
   // Normalize the public symbol info stream. There's a DWORD of padding at
   // offset 24 that we want to zero.
+  if (!RecordPdbStreamPages(dbi_header->public_symbol_info_stream))
+    return false;
   scoped_refptr<PdbStream> pubsym_reader =
       GetWritableStream(dbi_header->public_symbol_info_stream, pdb_file_.get());
   scoped_refptr<WritablePdbStream> pubsym_writer =
@@ -907,6 +946,36 @@ bool ZapTimestamp::LoadAndUpdatePdbFile() {
   return true;
 }
 
+bool ZapTimestamp::RecordPdbStreamPages(size_t index) {
+  DCHECK(pdb_file_.get() != NULL);
+
+  if (!patch_pdb_in_place_)
+    return true;
+
+  if (index >= pdb_file_->StreamCount()) {
+    LOG(ERROR) << "PDB stream " << index << " does not exist.";
+    return false;
+  }
+
+  // Empty streams have no pages, and nothing to patch.
+  scoped_refptr<PdbStream> stream = pdb_file_->GetStream(index);
+  if (stream.get() == NULL)
+    return true;
+
+  base::FilePath path;
+  uint32_t page_size = 0;
+  std::vector<uint32_t> pages;
+  if (!stream->GetFilePages(&path, &page_size, &pages)) {
+    LOG(ERROR) << "PDB stream " << index << " is not backed by the PDB file.";
+    return false;
+  }
+  DCHECK(pdb_page_size_ == 0 || pdb_page_size_ == page_size);
+  pdb_page_size_ = page_size;
+
+  pdb_stream_pages_[index].swap(pages);
+  return true;
+}
+
 bool ZapTimestamp::WritePeFile() {
   if (core::CompareFilePaths(input_image_, output_image_) !=
       core::kEquivalentFilePaths) {
@@ -917,22 +986,19 @@ bool ZapTimestamp::WritePeFile() {
     }
   }
 
+  // This also updates the checksum.
   if (!UpdateFileInPlace(output_image_, pe_file_addr_space_))
     return false;
 
-  LOG(INFO) << "Updating checksum for PE file: " << output_image_.value();
-  if (!pe::PEFileWriter::UpdateFileChecksum(output_image_)) {
-    LOG(ERROR) << "Failed to update checksum for PE file: "
-               << output_image_.value();
-    return false;
-  }
-
   return true;
 }
 
 bool ZapTimestamp::WritePdbFile() {
   DCHECK(!input_pdb_.empty());
 
+  if (patch_pdb_in_place_)
+    return WritePdbFileInPlace();
+
   // We actually completely rewrite the PDB file to a temporary location, and
   // then move it over top of the existing one. This is because pdb_file_
   // actually has an open file handle to the original PDB.
@@ -973,4 +1039,62 @@ bool ZapTimestamp::WritePdbFile() {
   return true;
 }
 
+bool ZapTimestamp::WritePdbFileInPlace() {
+  DCHECK(!input_pdb_.empty());
+  DCHECK(patch_pdb_in_place_);
+
+  // Read the contents of the modified streams while the input PDB is still
+  // open, then release it so that the output can be opened for writing.
+  typedef std::map<size_t, std::vector<uint8_t>> StreamDataMap;
+  StreamDataMap stream_data;
+  PdbStreamPagesMap::const_iterator it = pdb_stream_pages_.begin();
+  for (; it != pdb_stream_pages_.end(); ++it) {
+    // Streams that have been removed are overwritten with zeros. The length of
+    // the other streams is unchanged by the normalization.
+    std::vector<uint8_t>& data = stream_data[it->first];
+    data.resize(it->second.size() * pdb_page_size_);
+    scoped_refptr<PdbStream> stream = pdb_file_->GetStream(it->first);
+    if (stream.get() == NULL)
+      continue;
+
+    DCHECK_LE(stream->length(), data.size());
+    if (!stream->ReadBytesAt(0, stream->length(), data.data())) {
+      LOG(ERROR) << "Failed to read PDB stream " << it->first << ".";
+      return false;
+    }
+  }
+  pdb_file_.reset(NULL);
+
+  if (core::CompareFilePaths(input_pdb_, output_pdb_) !=
+      core::kEquivalentFilePaths) {
+    if (::CopyFileW(input_pdb_.value().c_str(), output_pdb_.value().c_str(),
+                    FALSE) == FALSE) {
+      LOG(ERROR) << "Failed to write output PDB: " << output_pdb_.value();
+      return false;
+    }
+  }
+
+  LOG(INFO) << "Patching PDB file: " << output_pdb_.value();
+  base::ScopedFILE file(base::OpenFile(output_pdb_, "rb+"));
+  if (file.get() == NULL) {
+    LOG(ERROR) << "Unable to open file for updating: " << output_pdb_.value();
+    return false;
+  }
+
+  for (it = pdb_stream_pages_.begin(); it != pdb_stream_pages_.end(); ++it) {
+    const std::vector<uint8_t>& data = stream_data[it->first];
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      if (::fseek(file.get(), it->second[i] * pdb_page_size_, SEEK_SET) != 0 ||
+          ::fwrite(data.data() + i * pdb_page_size_, 1, pdb_page_size_,
+                   file.get()) != pdb_page_size_) {
+        LOG(ERROR) << "Failed to write page " << it->second[i]
+                   << " of PDB file: " << output_pdb_.value();
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 }  // namespace zap_timestamp
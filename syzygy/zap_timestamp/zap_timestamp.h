@@ -18,6 +18,9 @@
 #ifndef SYZYGY_ZAP_TIMESTAMP_ZAP_TIMESTAMP_H_
 #define SYZYGY_ZAP_TIMESTAMP_ZAP_TIMESTAMP_H_
 
+#include <map>
+#include <vector>
+
 #include "base/files/file_path.h"
 #include "base/strings/string_piece.h"
 #include "syzygy/block_graph/block_graph.h"
@@ -30,6 +33,11 @@ namespace zap_timestamp {
 
 // Utility class for normalizing a PE file and the matching PDB file. They vary
 // largely in terms of timestamps and hash values, hence the name of the class.
+//
+// By default the PDB file is completely rewritten, which canonicalizes its
+// layout. In in-place mode only the modified stream pages are written back to
+// the existing file, which is much faster for large PDBs but preserves the
+// page layout chosen by the linker.
 class ZapTimestamp {
  public:
   ZapTimestamp();
@@ -57,6 +65,9 @@ class ZapTimestamp {
   void set_overwrite(bool overwrite) {
     overwrite_ = overwrite;
   }
+  void set_patch_pdb_in_place(bool patch_pdb_in_place) {
+    patch_pdb_in_place_ = patch_pdb_in_place;
+  }
   void set_timestamp_value(size_t timestamp_value) {
     timestamp_data_ = static_cast<size_t>(timestamp_value);
   }
@@ -71,6 +82,7 @@ class ZapTimestamp {
   bool write_image() const { return write_image_; }
   bool write_pdb() const { return write_pdb_; }
   bool overwrite() const { return overwrite_; }
+  bool patch_pdb_in_place() const { return patch_pdb_in_place_; }
   size_t timestamp_value() const {
     return static_cast<size_t>(timestamp_data_);
   }
@@ -118,10 +130,16 @@ class ZapTimestamp {
   // Loads the PDB file and updates its in-memory representation.
   bool LoadAndUpdatePdbFile();
 
+  // Remembers the pages of the given PDB stream in the input PDB file, so
+  // that the stream can later be patched in place. Must be called before the
+  // stream is replaced in pdb_file_.
+  bool RecordPdbStreamPages(size_t index);
+
   // @{
   // These do the actual writing of the individual files.
   bool WritePeFile();
   bool WritePdbFile();
+  bool WritePdbFileInPlace();
   // @}
 
   // Initialized by DecomposePeFile.
@@ -136,6 +154,12 @@ class ZapTimestamp {
   // Populated by LoadPdbFile and modified by UpdatePdbFile.
   std::unique_ptr<pdb::PdbFile> pdb_file_;
 
+  // In in-place mode, the pages in the input PDB file of each stream that is
+  // modified. Populated by LoadAndUpdatePdbFile.
+  typedef std::map<size_t, std::vector<uint32_t>> PdbStreamPagesMap;
+  PdbStreamPagesMap pdb_stream_pages_;
+  uint32_t pdb_page_size_;
+
   // These house the new values to be written when the image is zapped.
   DWORD timestamp_data_;
   DWORD pdb_age_data_;
@@ -149,6 +173,7 @@ class ZapTimestamp {
   bool write_image_;
   bool write_pdb_;
   bool overwrite_;
+  bool patch_pdb_in_place_;
 
   DISALLOW_COPY_AND_ASSIGN(ZapTimestamp);
 };
@@ -44,6 +44,10 @@ const char kUsageFormatStr[] =
     "    --output-image is, then will place the PDB alongside the output\n"
     "    image with the same basename. If this is specified then\n"
     "    --output-image must also be specified."
+    "  --patch-pdb-in-place\n"
+    "    If specified the PDB file is patched in place rather than being\n"
+    "    completely rewritten. This is much faster for large PDB files, but\n"
+    "    preserves the page layout chosen by the linker.\n"
     "  --overwrite\n"
     "    If specified will allow overwriting of existing output files. Must\n"
     "    be specified for in place processing.\n"
@@ -86,6 +90,7 @@ bool ZapTimestampApp::ParseCommandLine(const base::CommandLine* command_line) {
   zap_.set_write_image(!command_line->HasSwitch("no-write-image"));
   zap_.set_write_pdb(!command_line->HasSwitch("no-write-pdb"));
   zap_.set_overwrite(command_line->HasSwitch("overwrite"));
+  zap_.set_patch_pdb_in_place(command_line->HasSwitch("patch-pdb-in-place"));
 
   if (command_line->HasSwitch("timestamp-value")) {
     size_t timestamp_value = 0;
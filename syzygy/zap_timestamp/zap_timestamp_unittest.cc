@@ -18,6 +18,10 @@
 #include "base/files/scoped_temp_dir.h"
 #include "gtest/gtest.h"
 #include "syzygy/core/unittest_util.h"
+#include "syzygy/pdb/pdb_constants.h"
+#include "syzygy/pdb/pdb_file.h"
+#include "syzygy/pdb/pdb_reader.h"
+#include "syzygy/pe/pdb_info.h"
 #include "syzygy/pe/unittest_util.h"
 
 namespace zap_timestamp {
@@ -89,6 +93,22 @@ class ZapTimestampTest : public testing::Test {
     ASSERT_TRUE(base::CopyFileW(pe_path, temp_pe_path_));
   }
 
+  // Reads the contents of the given stream of the PDB at @p pdb_path.
+  void ReadPdbStream(const base::FilePath& pdb_path,
+                     size_t index,
+                     std::vector<uint8_t>* data) {
+    ASSERT_TRUE(data != NULL);
+    pdb::PdbFile pdb_file;
+    pdb::PdbReader pdb_reader;
+    ASSERT_TRUE(pdb_reader.Read(pdb_path, &pdb_file));
+    ASSERT_GT(pdb_file.StreamCount(), index);
+    scoped_refptr<pdb::PdbStream> stream = pdb_file.GetStream(index);
+    ASSERT_TRUE(stream.get() != NULL);
+    data->resize(stream->length());
+    if (!data->empty())
+      ASSERT_TRUE(stream->ReadBytesAt(0, data->size(), data->data()));
+  }
+
   base::ScopedTempDir temp_dir_;
   std::vector<PePdbPathPair> test_paths_;
 
@@ -334,4 +354,69 @@ TEST_F(ZapTimestampTest, IsIdempotentNoPdb) {
   EXPECT_TRUE(base::ContentsEqual(temp_pe_path_, pe_path_0));
 }
 
+TEST_F(ZapTimestampTest, PatchPdbInPlaceMatchesRewrite) {
+  // Zap the first set of files by rewriting the PDB, and set them aside.
+  ASSERT_NO_FATAL_FAILURE(CopyTestData(0));
+  ZapTimestamp zap0;
+  zap0.set_input_image(temp_pe_path_);
+  zap0.set_overwrite(true);
+  EXPECT_TRUE(zap0.Init());
+  EXPECT_TRUE(zap0.Zap());
+
+  base::FilePath pe_path_0 = temp_dir_.path().Append(L"test_dll_0.dll");
+  base::FilePath pdb_path_0 = temp_dir_.path().Append(L"test_dll_0.pdb");
+  ASSERT_TRUE(base::Move(temp_pe_path_, pe_path_0));
+  ASSERT_TRUE(base::Move(temp_pdb_path_, pdb_path_0));
+
+  // Zap a fresh copy, patching the PDB in place.
+  ASSERT_NO_FATAL_FAILURE(CopyTestData(0));
+  ZapTimestamp zap1;
+  zap1.set_input_image(temp_pe_path_);
+  zap1.set_overwrite(true);
+  zap1.set_patch_pdb_in_place(true);
+  EXPECT_TRUE(zap1.Init());
+  EXPECT_TRUE(zap1.Zap());
+
+  // The images are identical, and the PDB still matches the image.
+  EXPECT_TRUE(base::ContentsEqual(temp_pe_path_, pe_path_0));
+  EXPECT_TRUE(pe::PeAndPdbAreMatched(temp_pe_path_, temp_pdb_path_));
+
+  // The normalized streams are identical, even though the layout of the PDB
+  // files differs.
+  const size_t kStreams[] = { pdb::kPdbHeaderInfoStream, pdb::kDbiStream };
+  for (size_t i = 0; i < arraysize(kStreams); ++i) {
+    std::vector<uint8_t> rewritten;
+    std::vector<uint8_t> patched;
+    ASSERT_NO_FATAL_FAILURE(ReadPdbStream(pdb_path_0, kStreams[i], &rewritten));
+    ASSERT_NO_FATAL_FAILURE(ReadPdbStream(temp_pdb_path_, kStreams[i],
+                                          &patched));
+    EXPECT_EQ(rewritten, patched);
+  }
+}
+
+TEST_F(ZapTimestampTest, PatchPdbInPlaceIsIdempotent) {
+  ASSERT_NO_FATAL_FAILURE(CopyTestData(0));
+  ZapTimestamp zap0;
+  zap0.set_input_image(temp_pe_path_);
+  zap0.set_overwrite(true);
+  zap0.set_patch_pdb_in_place(true);
+  EXPECT_TRUE(zap0.Init());
+  EXPECT_TRUE(zap0.Zap());
+
+  base::FilePath pe_path_0 = temp_dir_.path().Append(L"test_dll_0.dll");
+  base::FilePath pdb_path_0 = temp_dir_.path().Append(L"test_dll_0.pdb");
+  ASSERT_TRUE(base::CopyFile(temp_pe_path_, pe_path_0));
+  ASSERT_TRUE(base::CopyFile(temp_pdb_path_, pdb_path_0));
+
+  ZapTimestamp zap1;
+  zap1.set_input_image(temp_pe_path_);
+  zap1.set_overwrite(true);
+  zap1.set_patch_pdb_in_place(true);
+  EXPECT_TRUE(zap1.Init());
+  EXPECT_TRUE(zap1.Zap());
+
+  EXPECT_TRUE(base::ContentsEqual(temp_pe_path_, pe_path_0));
+  EXPECT_TRUE(base::ContentsEqual(temp_pdb_path_, pdb_path_0));
+}
+
 }  // namespace zap_timestamp